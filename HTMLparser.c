@@ -43,6 +43,8 @@
 #include "private/io.h"
 #include "private/memory.h"
 #include "private/parser.h"
+#include "private/simd.h"
+#include "private/trace.h"
 #include "private/tree.h"
 
 #define HTML_MAX_NAMELEN 1000
@@ -66,36 +68,60 @@ typedef enum {
     INSERT_IN_BODY = 10
 } htmlInsertMode;
 
-typedef const unsigned htmlAsciiMask[2];
+/*
+ * Terminating characters of htmlParseData. The set for the SIMD
+ * kernels also contains the characters which need special handling
+ * in the data.
+ */
+typedef struct {
+    unsigned bits[2];
+    xmlAsciiSet set;
+} htmlAsciiMask;
+
+#define HTML_DATA_SPECIAL0 (1u << 0x00 | 1u << 0x0A | 1u << 0x0D)
+#define HTML_DATA_SPECIAL1 (1u << ('&' - 32))
 
-static htmlAsciiMask MASK_DQ = {
+#define HTML_ASCII_MASK(m0, m1) { \
+    { (m0), (m1) }, \
+    XML_ASCII_SET((m0) | HTML_DATA_SPECIAL0, (m1) | HTML_DATA_SPECIAL1) \
+}
+
+static const htmlAsciiMask MASK_DQ = HTML_ASCII_MASK(
     0,
-    1u << ('"' - 32),
-};
-static htmlAsciiMask MASK_SQ = {
+    1u << ('"' - 32)
+);
+static const htmlAsciiMask MASK_SQ = HTML_ASCII_MASK(
     0,
-    1u << ('\'' - 32),
-};
-static htmlAsciiMask MASK_GT = {
+    1u << ('\'' - 32)
+);
+static const htmlAsciiMask MASK_GT = HTML_ASCII_MASK(
     0,
-    1u << ('>' - 32),
-};
-static htmlAsciiMask MASK_DASH = {
+    1u << ('>' - 32)
+);
+static const htmlAsciiMask MASK_DASH = HTML_ASCII_MASK(
     0,
-    1u << ('-' - 32),
-};
-static htmlAsciiMask MASK_WS_GT = {
+    1u << ('-' - 32)
+);
+static const htmlAsciiMask MASK_WS_GT = HTML_ASCII_MASK(
     1u << 0x09 | 1u << 0x0A | 1u << 0x0C | 1u << 0x0D,
-    1u << (' ' - 32) | 1u << ('>' - 32),
-};
-static htmlAsciiMask MASK_DQ_GT = {
+    1u << (' ' - 32) | 1u << ('>' - 32)
+);
+static const htmlAsciiMask MASK_DQ_GT = HTML_ASCII_MASK(
     0,
-    1u << ('"' - 32) | 1u << ('>' - 32),
-};
-static htmlAsciiMask MASK_SQ_GT = {
+    1u << ('"' - 32) | 1u << ('>' - 32)
+);
+static const htmlAsciiMask MASK_SQ_GT = HTML_ASCII_MASK(
     0,
-    1u << ('\'' - 32) | 1u << ('>' - 32),
-};
+    1u << ('\'' - 32) | 1u << ('>' - 32)
+);
+
+/*
+ * Characters which stop the accelerator in htmlParseCharData.
+ */
+static const xmlAsciiSet htmlCharDataSet = XML_ASCII_SET(
+    1u << 0x00 | 1u << 0x0A | 1u << 0x0D,
+    1u << ('&' - 32) | 1u << ('-' - 32) | 1u << ('<' - 32)
+);
 
 static int htmlOmittedDefaultValue = 1;
 
@@ -176,6 +202,8 @@ htmlnamePush(htmlParserCtxtPtr ctxt, const xmlChar * value)
     }
     ctxt->nameTab[ctxt->nameNr] = value;
     ctxt->name = value;
+    if (ctxt->nameNr >= ctxt->stats.maxDepth)
+        ctxt->stats.maxDepth = ctxt->nameNr + 1;
     return (ctxt->nameNr++);
 }
 /**
@@ -360,10 +388,10 @@ htmlFindEncoding(xmlParserCtxtPtr ctxt) {
 }
 
 static int
-htmlMaskMatch(htmlAsciiMask mask, unsigned c) {
+htmlMaskMatch(const htmlAsciiMask *mask, unsigned c) {
     if (c >= 64)
         return(0);
-    return((mask[c/32] >> (c & 31)) & 1);
+    return((mask->bits[c/32] >> (c & 31)) & 1);
 }
 
 static int
@@ -903,265 +931,7 @@ html40ElementTable[] = {
 }
 };
 
-typedef struct {
-    const char *oldTag;
-    const char *newTag;
-} htmlStartCloseEntry;
-
-/*
- * start tags that imply the end of current element
- */
-static const htmlStartCloseEntry htmlStartClose[] = {
-    { "a", "a" },
-    { "a", "fieldset" },
-    { "a", "table" },
-    { "a", "td" },
-    { "a", "th" },
-    { "address", "dd" },
-    { "address", "dl" },
-    { "address", "dt" },
-    { "address", "form" },
-    { "address", "li" },
-    { "address", "ul" },
-    { "b", "center" },
-    { "b", "p" },
-    { "b", "td" },
-    { "b", "th" },
-    { "big", "p" },
-    { "caption", "col" },
-    { "caption", "colgroup" },
-    { "caption", "tbody" },
-    { "caption", "tfoot" },
-    { "caption", "thead" },
-    { "caption", "tr" },
-    { "col", "col" },
-    { "col", "colgroup" },
-    { "col", "tbody" },
-    { "col", "tfoot" },
-    { "col", "thead" },
-    { "col", "tr" },
-    { "colgroup", "colgroup" },
-    { "colgroup", "tbody" },
-    { "colgroup", "tfoot" },
-    { "colgroup", "thead" },
-    { "colgroup", "tr" },
-    { "dd", "dt" },
-    { "dir", "dd" },
-    { "dir", "dl" },
-    { "dir", "dt" },
-    { "dir", "form" },
-    { "dir", "ul" },
-    { "dl", "form" },
-    { "dl", "li" },
-    { "dt", "dd" },
-    { "dt", "dl" },
-    { "font", "center" },
-    { "font", "td" },
-    { "font", "th" },
-    { "form", "form" },
-    { "h1", "fieldset" },
-    { "h1", "form" },
-    { "h1", "li" },
-    { "h1", "p" },
-    { "h1", "table" },
-    { "h2", "fieldset" },
-    { "h2", "form" },
-    { "h2", "li" },
-    { "h2", "p" },
-    { "h2", "table" },
-    { "h3", "fieldset" },
-    { "h3", "form" },
-    { "h3", "li" },
-    { "h3", "p" },
-    { "h3", "table" },
-    { "h4", "fieldset" },
-    { "h4", "form" },
-    { "h4", "li" },
-    { "h4", "p" },
-    { "h4", "table" },
-    { "h5", "fieldset" },
-    { "h5", "form" },
-    { "h5", "li" },
-    { "h5", "p" },
-    { "h5", "table" },
-    { "h6", "fieldset" },
-    { "h6", "form" },
-    { "h6", "li" },
-    { "h6", "p" },
-    { "h6", "table" },
-    { "head", "a" },
-    { "head", "abbr" },
-    { "head", "acronym" },
-    { "head", "address" },
-    { "head", "b" },
-    { "head", "bdo" },
-    { "head", "big" },
-    { "head", "blockquote" },
-    { "head", "body" },
-    { "head", "br" },
-    { "head", "center" },
-    { "head", "cite" },
-    { "head", "code" },
-    { "head", "dd" },
-    { "head", "dfn" },
-    { "head", "dir" },
-    { "head", "div" },
-    { "head", "dl" },
-    { "head", "dt" },
-    { "head", "em" },
-    { "head", "fieldset" },
-    { "head", "font" },
-    { "head", "form" },
-    { "head", "frameset" },
-    { "head", "h1" },
-    { "head", "h2" },
-    { "head", "h3" },
-    { "head", "h4" },
-    { "head", "h5" },
-    { "head", "h6" },
-    { "head", "hr" },
-    { "head", "i" },
-    { "head", "iframe" },
-    { "head", "img" },
-    { "head", "kbd" },
-    { "head", "li" },
-    { "head", "listing" },
-    { "head", "map" },
-    { "head", "menu" },
-    { "head", "ol" },
-    { "head", "p" },
-    { "head", "pre" },
-    { "head", "q" },
-    { "head", "s" },
-    { "head", "samp" },
-    { "head", "small" },
-    { "head", "span" },
-    { "head", "strike" },
-    { "head", "strong" },
-    { "head", "sub" },
-    { "head", "sup" },
-    { "head", "table" },
-    { "head", "tt" },
-    { "head", "u" },
-    { "head", "ul" },
-    { "head", "var" },
-    { "head", "xmp" },
-    { "hr", "form" },
-    { "i", "center" },
-    { "i", "p" },
-    { "i", "td" },
-    { "i", "th" },
-    { "legend", "fieldset" },
-    { "li", "li" },
-    { "link", "body" },
-    { "link", "frameset" },
-    { "listing", "dd" },
-    { "listing", "dl" },
-    { "listing", "dt" },
-    { "listing", "fieldset" },
-    { "listing", "form" },
-    { "listing", "li" },
-    { "listing", "table" },
-    { "listing", "ul" },
-    { "menu", "dd" },
-    { "menu", "dl" },
-    { "menu", "dt" },
-    { "menu", "form" },
-    { "menu", "ul" },
-    { "ol", "form" },
-    { "option", "optgroup" },
-    { "option", "option" },
-    { "p", "address" },
-    { "p", "blockquote" },
-    { "p", "body" },
-    { "p", "caption" },
-    { "p", "center" },
-    { "p", "col" },
-    { "p", "colgroup" },
-    { "p", "dd" },
-    { "p", "dir" },
-    { "p", "div" },
-    { "p", "dl" },
-    { "p", "dt" },
-    { "p", "fieldset" },
-    { "p", "form" },
-    { "p", "frameset" },
-    { "p", "h1" },
-    { "p", "h2" },
-    { "p", "h3" },
-    { "p", "h4" },
-    { "p", "h5" },
-    { "p", "h6" },
-    { "p", "head" },
-    { "p", "hr" },
-    { "p", "li" },
-    { "p", "listing" },
-    { "p", "menu" },
-    { "p", "ol" },
-    { "p", "p" },
-    { "p", "pre" },
-    { "p", "table" },
-    { "p", "tbody" },
-    { "p", "td" },
-    { "p", "tfoot" },
-    { "p", "th" },
-    { "p", "title" },
-    { "p", "tr" },
-    { "p", "ul" },
-    { "p", "xmp" },
-    { "pre", "dd" },
-    { "pre", "dl" },
-    { "pre", "dt" },
-    { "pre", "fieldset" },
-    { "pre", "form" },
-    { "pre", "li" },
-    { "pre", "table" },
-    { "pre", "ul" },
-    { "s", "p" },
-    { "script", "noscript" },
-    { "small", "p" },
-    { "span", "td" },
-    { "span", "th" },
-    { "strike", "p" },
-    { "style", "body" },
-    { "style", "frameset" },
-    { "tbody", "tbody" },
-    { "tbody", "tfoot" },
-    { "td", "tbody" },
-    { "td", "td" },
-    { "td", "tfoot" },
-    { "td", "th" },
-    { "td", "tr" },
-    { "tfoot", "tbody" },
-    { "th", "tbody" },
-    { "th", "td" },
-    { "th", "tfoot" },
-    { "th", "th" },
-    { "th", "tr" },
-    { "thead", "tbody" },
-    { "thead", "tfoot" },
-    { "title", "body" },
-    { "title", "frameset" },
-    { "tr", "tbody" },
-    { "tr", "tfoot" },
-    { "tr", "tr" },
-    { "tt", "p" },
-    { "u", "p" },
-    { "u", "td" },
-    { "u", "th" },
-    { "ul", "address" },
-    { "ul", "form" },
-    { "ul", "menu" },
-    { "ul", "pre" },
-    { "xmp", "dd" },
-    { "xmp", "dl" },
-    { "xmp", "dt" },
-    { "xmp", "fieldset" },
-    { "xmp", "form" },
-    { "xmp", "li" },
-    { "xmp", "table" },
-    { "xmp", "ul" }
-};
+#include "codegen/htmlelem.inc"
 
 /*
  * The list of HTML attributes which are of content %Script;
@@ -1245,12 +1015,41 @@ void
 htmlInitAutoClose(void) {
 }
 
+/**
+ * Map a tag name to its index in the generated tables.
+ *
+ * @param name  the tag name
+ * @param nocase  whether to compare case-insensitively
+ * @returns the tag index or -1 if the tag isn't known.
+ */
 static int
-htmlCompareTags(const void *key, const void *member) {
-    const xmlChar *tag = (const xmlChar *) key;
-    const htmlElemDesc *desc = (const htmlElemDesc *) member;
+htmlTagIndex(const xmlChar *name, int nocase) {
+    const xmlChar *cur;
+    unsigned hash = HTML_TAG_HASH_SEED;
+    int idx;
+
+    if (name == NULL)
+        return(-1);
+
+    for (cur = name; *cur != 0; cur++) {
+        int c = *cur;
+
+        if (cur - name >= HTML_TAG_MAX_LEN)
+            return(-1);
+        if ((c >= 'A') && (c <= 'Z'))
+            c += 'a' - 'A';
+        hash = ((hash ^ c) * 0x01000193u) & 0xFFFFFFFFu;
+    }
 
-    return(xmlStrcasecmp(tag, BAD_CAST desc->name));
+    idx = htmlTagHashTab[hash >> (32 - HTML_TAG_HASH_BITS)] - 1;
+    if (idx < 0)
+        return(-1);
+    if (nocase ?
+        xmlStrcasecmp(name, BAD_CAST htmlTagNames[idx]) != 0 :
+        strcmp((const char *) name, htmlTagNames[idx]) != 0)
+        return(-1);
+
+    return(idx);
 }
 
 /**
@@ -1263,12 +1062,16 @@ htmlCompareTags(const void *key, const void *member) {
  */
 const htmlElemDesc *
 htmlTagLookup(const xmlChar *tag) {
+    int idx;
+
     if (tag == NULL)
         return(NULL);
 
-    return((const htmlElemDesc *) bsearch(tag, html40ElementTable,
-                sizeof(html40ElementTable) / sizeof(htmlElemDesc),
-                sizeof(htmlElemDesc), htmlCompareTags));
+    idx = htmlTagIndex(tag, 1);
+    if ((idx < 0) || (idx >= HTML_ELEM_COUNT))
+        return(NULL);
+
+    return(&html40ElementTable[idx]);
 }
 
 /**
@@ -1287,17 +1090,26 @@ htmlGetEndPriority (const xmlChar *name) {
 }
 
 
+/**
+ * Checks whether the new tag is one of the registered valid tags for
+ * closing old.
+ *
+ * @param newIdx  The index of the new tag
+ * @param oldtag  The old tag name
+ * @returns 0 if no, 1 if yes.
+ */
 static int
-htmlCompareStartClose(const void *vkey, const void *member) {
-    const htmlStartCloseEntry *key = (const htmlStartCloseEntry *) vkey;
-    const htmlStartCloseEntry *entry = (const htmlStartCloseEntry *) member;
-    int ret;
+htmlCheckAutoCloseIndex(int newIdx, const xmlChar *oldtag)
+{
+    int oldIdx;
 
-    ret = strcmp(key->oldTag, entry->oldTag);
-    if (ret == 0)
-        ret = strcmp(key->newTag, entry->newTag);
+    if (newIdx < 0)
+        return(0);
+    oldIdx = htmlTagIndex(oldtag, 0);
+    if (oldIdx < 0)
+        return(0);
 
-    return(ret);
+    return((htmlStartCloseTab[oldIdx][newIdx >> 3] >> (newIdx & 7)) & 1);
 }
 
 /**
@@ -1311,15 +1123,7 @@ htmlCompareStartClose(const void *vkey, const void *member) {
 static int
 htmlCheckAutoClose(const xmlChar * newtag, const xmlChar * oldtag)
 {
-    htmlStartCloseEntry key;
-    void *res;
-
-    key.oldTag = (const char *) oldtag;
-    key.newTag = (const char *) newtag;
-    res = bsearch(&key, htmlStartClose,
-            sizeof(htmlStartClose) / sizeof(htmlStartCloseEntry),
-            sizeof(htmlStartCloseEntry), htmlCompareStartClose);
-    return(res != NULL);
+    return(htmlCheckAutoCloseIndex(htmlTagIndex(newtag, 0), oldtag));
 }
 
 /**
@@ -1394,7 +1198,7 @@ htmlAutoCloseOnEnd(htmlParserCtxtPtr ctxt)
 
 /**
  * The HTML DTD allows a tag to implicitly close other tags.
- * The list is kept in htmlStartClose array. This function is
+ * The rules are kept in the htmlStartCloseTab matrix. This function is
  * called when a new tag has been detected and generates the
  * appropriates closes if possible/needed.
  * If newtag is NULL this mean we are at the end of the resource
@@ -1406,14 +1210,20 @@ htmlAutoCloseOnEnd(htmlParserCtxtPtr ctxt)
 static void
 htmlAutoClose(htmlParserCtxtPtr ctxt, const xmlChar * newtag)
 {
+    int newIdx;
+
     if (ctxt->options & HTML_PARSE_HTML5)
         return;
 
     if (newtag == NULL)
         return;
 
+    newIdx = htmlTagIndex(newtag, 0);
+    if (newIdx < 0)
+        return;
+
     while ((ctxt->name != NULL) &&
-           (htmlCheckAutoClose(newtag, ctxt->name))) {
+           (htmlCheckAutoCloseIndex(newIdx, ctxt->name))) {
 	htmlParserFinishElementParsing(ctxt);
         if ((ctxt->sax != NULL) && (ctxt->sax->endElement != NULL))
             ctxt->sax->endElement(ctxt->userData, ctxt->name);
@@ -1423,7 +1233,7 @@ htmlAutoClose(htmlParserCtxtPtr ctxt, const xmlChar * newtag)
 
 /**
  * The HTML DTD allows a tag to implicitly close other tags.
- * The list is kept in htmlStartClose array. This function checks
+ * The rules are kept in the htmlStartCloseTab matrix. This function checks
  * if the element or one of it's children would autoclose the
  * given tag.
  *
@@ -1451,7 +1261,7 @@ htmlAutoCloseTag(xmlDoc *doc, const xmlChar *name, xmlNode *elem) {
 
 /**
  * The HTML DTD allows a tag to implicitly close other tags.
- * The list is kept in htmlStartClose array. This function checks
+ * The rules are kept in the htmlStartCloseTab matrix. This function checks
  * if a tag is autoclosed by one of it's child
  *
  * @deprecated Internal function, don't use.
@@ -1483,28 +1293,29 @@ htmlIsAutoClosed(xmlDoc *doc, xmlNode *elem) {
  */
 static void
 htmlCheckImplied(htmlParserCtxtPtr ctxt, const xmlChar *newtag) {
-    int i;
+    int i, idx;
 
     if (ctxt->options & (HTML_PARSE_NOIMPLIED | HTML_PARSE_HTML5))
         return;
     if (!htmlOmittedDefaultValue)
 	return;
-    if (xmlStrEqual(newtag, BAD_CAST"html"))
+    idx = htmlTagIndex(newtag, 0);
+    if (idx == HTML_TAG_HTML)
 	return;
     if (ctxt->nameNr <= 0) {
 	htmlnamePush(ctxt, BAD_CAST"html");
 	if ((ctxt->sax != NULL) && (ctxt->sax->startElement != NULL))
 	    ctxt->sax->startElement(ctxt->userData, BAD_CAST"html", NULL);
     }
-    if ((xmlStrEqual(newtag, BAD_CAST"body")) || (xmlStrEqual(newtag, BAD_CAST"head")))
+    if ((idx == HTML_TAG_BODY) || (idx == HTML_TAG_HEAD))
         return;
     if ((ctxt->nameNr <= 1) &&
-        ((xmlStrEqual(newtag, BAD_CAST"script")) ||
-	 (xmlStrEqual(newtag, BAD_CAST"style")) ||
-	 (xmlStrEqual(newtag, BAD_CAST"meta")) ||
-	 (xmlStrEqual(newtag, BAD_CAST"link")) ||
-	 (xmlStrEqual(newtag, BAD_CAST"title")) ||
-	 (xmlStrEqual(newtag, BAD_CAST"base")))) {
+        ((idx == HTML_TAG_SCRIPT) ||
+	 (idx == HTML_TAG_STYLE) ||
+	 (idx == HTML_TAG_META) ||
+	 (idx == HTML_TAG_LINK) ||
+	 (idx == HTML_TAG_TITLE) ||
+	 (idx == HTML_TAG_BASE))) {
         if (ctxt->html >= INSERT_IN_HEAD) {
             /* we already saw or generated an <head> before */
             return;
@@ -1516,9 +1327,9 @@ htmlCheckImplied(htmlParserCtxtPtr ctxt, const xmlChar *newtag) {
         htmlnamePush(ctxt, BAD_CAST"head");
         if ((ctxt->sax != NULL) && (ctxt->sax->startElement != NULL))
             ctxt->sax->startElement(ctxt->userData, BAD_CAST"head", NULL);
-    } else if ((!xmlStrEqual(newtag, BAD_CAST"noframes")) &&
-	       (!xmlStrEqual(newtag, BAD_CAST"frame")) &&
-	       (!xmlStrEqual(newtag, BAD_CAST"frameset"))) {
+    } else if ((idx != HTML_TAG_NOFRAMES) &&
+	       (idx != HTML_TAG_FRAME) &&
+	       (idx != HTML_TAG_FRAMESET)) {
         if (ctxt->html >= INSERT_IN_BODY) {
             /* we already saw or generated a <body> before */
             return;
@@ -2434,18 +2245,18 @@ htmlCodePointToUtf8(int c, xmlChar *out, int *osize) {
 
 #include "codegen/html5ent.inc"
 
-#define ENT_F_SEMICOLON 0x80u
-#define ENT_F_SUBTABLE  0x40u
-#define ENT_F_ALL       0xC0u
+#define ENT_F_LEGACY    0x80u
+#define ENT_F_VALUE     0x40u
+#define ENT_F_COUNT     0x3Fu
 
 static const xmlChar *
 htmlFindEntityPrefix(const xmlChar *string, size_t slen, int isAttr,
                      int *nlen, int *rlen) {
+    const xmlChar *node;
     const xmlChar *match = NULL;
-    unsigned left, right;
-    int first = string[0];
     size_t matchLen = 0;
-    size_t soff = 1;
+    size_t i;
+    int first = string[0];
 
     if (slen < 2)
         return(NULL);
@@ -2453,77 +2264,62 @@ htmlFindEntityPrefix(const xmlChar *string, size_t slen, int isAttr,
         return(NULL);
 
     /*
-     * Look up range by first character
+     * Walk the trie, remembering the longest match
      */
-    first &= 63;
-    left = htmlEntAlpha[first*3] | htmlEntAlpha[first*3+1] << 8;
-    right = left + htmlEntAlpha[first*3+2];
+    node = htmlEntTrie + htmlEntAlpha[first & 63];
+    i = 1;
 
-    /*
-     * Binary search
-     */
-    while (left < right) {
-        const xmlChar *bytes;
-        unsigned mid;
-        size_t len;
-        int cmp;
-
-        mid = left + (right - left) / 2;
-        bytes = htmlEntStrings + htmlEntValues[mid];
-        len = bytes[0] & ~ENT_F_ALL;
-
-        cmp = string[soff] - bytes[1];
-
-        if (cmp == 0) {
-            if (slen < len) {
-                cmp = strncmp((const char *) string + soff + 1,
-                              (const char *) bytes + 2,
-                              slen - 1);
-                /* Prefix can never match */
-                if (cmp == 0)
-                    break;
-            } else {
-                cmp = strncmp((const char *) string + soff + 1,
-                              (const char *) bytes + 2,
-                              len - 1);
-            }
-        }
+    while (1) {
+        const xmlChar *chars;
+        unsigned header = node[0];
+        unsigned count = header & ENT_F_COUNT;
+        unsigned k;
+        int c;
 
-        if (cmp < 0) {
-            right = mid;
-        } else if (cmp > 0) {
-            left = mid + 1;
-        } else {
-            int term = soff + len < slen ? string[soff + len] : 0;
-            int isAlnum, isTerm;
-
-            isAlnum = IS_ALNUM(term);
-            isTerm = ((term == ';') ||
-                      ((bytes[0] & ENT_F_SEMICOLON) &&
-                       ((!isAttr) ||
-                        ((!isAlnum) && (term != '=')))));
-
-            if (isTerm) {
-                match = bytes + len + 1;
-                matchLen = soff + len;
-                if (term == ';')
-                    matchLen += 1;
-            }
+        chars = node + 1;
 
-            if (bytes[0] & ENT_F_SUBTABLE) {
-                if (isTerm)
-                    match += 2;
+        if (header & ENT_F_VALUE) {
+            const xmlChar *repl = htmlEntRepl + (node[1] | node[2] << 8);
+            int term = i < slen ? string[i] : 0;
 
-                if ((isAlnum) && (soff + len < slen)) {
-                    left = mid + bytes[len + 1];
-                    right = left + bytes[len + 2];
-                    soff += len;
-                    continue;
-                }
+            if (term == ';') {
+                match = repl;
+                matchLen = i + 1;
+                break;
             }
 
+            if ((header & ENT_F_LEGACY) &&
+                ((!isAttr) ||
+                 ((!IS_ALNUM(term)) && (term != '=')))) {
+                match = repl;
+                matchLen = i;
+            }
+
+            chars += 2;
+        }
+
+        if ((count == 0) || (i >= slen))
             break;
+
+        c = string[i];
+
+        if (count == 1) {
+            if (chars[0] != c)
+                break;
+            node = chars + 1;
+        } else {
+            const xmlChar *offsets = chars + count;
+
+            for (k = 0; k < count; k++) {
+                if (chars[k] >= c)
+                    break;
+            }
+            if ((k >= count) || (chars[k] != c))
+                break;
+            node = htmlEntTrie + (offsets[k*2] | offsets[k*2+1] << 8);
         }
+
+        i += 1;
     }
 
     if (match == NULL)
@@ -2546,7 +2342,7 @@ htmlFindEntityPrefix(const xmlChar *string, size_t slen, int isAttr,
  */
 
 static xmlChar *
-htmlParseData(htmlParserCtxtPtr ctxt, htmlAsciiMask mask,
+htmlParseData(htmlParserCtxtPtr ctxt, const htmlAsciiMask *mask,
               int comment, int refs, int maxLength) {
     xmlParserInputPtr input = ctxt->input;
     xmlChar *ret = NULL;
@@ -2615,6 +2411,18 @@ htmlParseData(htmlParserCtxtPtr ctxt, htmlAsciiMask mask,
                 break;
             }
 
+            if ((!ncr) && (avail >= 16)) {
+                const xmlChar *next;
+
+                next = xmlScanAsciiSet(in, in + avail, &mask->set);
+                if (next > in) {
+                    col += next - in;
+                    avail -= next - in;
+                    in = next;
+                    continue;
+                }
+            }
+
             cur = *in;
             size = 1;
             col += 1;
@@ -2879,16 +2687,16 @@ htmlParseAttValue(htmlParserCtxtPtr ctxt) {
 
     if (CUR == '"') {
         SKIP(1);
-	ret = htmlParseData(ctxt, MASK_DQ, 0, 1, maxLength);
+	ret = htmlParseData(ctxt, &MASK_DQ, 0, 1, maxLength);
         if (CUR == '"')
             SKIP(1);
     } else if (CUR == '\'') {
         SKIP(1);
-	ret = htmlParseData(ctxt, MASK_SQ, 0, 1, maxLength);
+	ret = htmlParseData(ctxt, &MASK_SQ, 0, 1, maxLength);
         if (CUR == '\'')
             SKIP(1);
     } else {
-	ret = htmlParseData(ctxt, MASK_WS_GT, 0, 1, maxLength);
+	ret = htmlParseData(ctxt, &MASK_WS_GT, 0, 1, maxLength);
     }
     return(ret);
 }
@@ -3027,6 +2835,13 @@ htmlParseCharData(htmlParserCtxtPtr ctxt, int partial) {
 
             /* Accelerator */
             if (!ncr) {
+                const xmlChar *next;
+
+                next = xmlScanAsciiSet(in, in + avail, &htmlCharDataSet);
+                col += next - in;
+                avail -= next - in;
+                in = next;
+
                 while (avail > 0) {
                     static const unsigned mask[8] = {
                         0x00002401, 0x10002040,
@@ -3375,7 +3190,7 @@ htmlParseComment(htmlParserCtxtPtr ctxt, int bogus) {
                     XML_MAX_TEXT_LENGTH;
 
     if (bogus) {
-        buf = htmlParseData(ctxt, MASK_GT, 0, 0, maxLength);
+        buf = htmlParseData(ctxt, &MASK_GT, 0, 0, maxLength);
         if (CUR == '>')
             SKIP(1);
         comment = buf;
@@ -3389,7 +3204,7 @@ htmlParseComment(htmlParserCtxtPtr ctxt, int bogus) {
         } else if ((CUR == '-') && (NXT(1) == '>')) {
             SKIP(2);
         } else {
-            buf = htmlParseData(ctxt, MASK_DASH, 1, 0, maxLength);
+            buf = htmlParseData(ctxt, &MASK_DASH, 1, 0, maxLength);
             comment = buf;
         }
     }
@@ -3432,12 +3247,12 @@ htmlParseDoctypeLiteral(htmlParserCtxtPtr ctxt) {
 
     if (CUR == '"') {
         SKIP(1);
-        ret = htmlParseData(ctxt, MASK_DQ_GT, 0, 0, maxLength);
+        ret = htmlParseData(ctxt, &MASK_DQ_GT, 0, 0, maxLength);
         if (CUR == '"')
             SKIP(1);
     } else if (CUR == '\'') {
         SKIP(1);
-        ret = htmlParseData(ctxt, MASK_SQ_GT, 0, 0, maxLength);
+        ret = htmlParseData(ctxt, &MASK_SQ_GT, 0, 0, maxLength);
         if (CUR == '\'')
             SKIP(1);
     } else {
@@ -3525,7 +3340,7 @@ htmlParseDocTypeDecl(htmlParserCtxtPtr ctxt) {
     SKIP_BLANKS;
 
     if ((ctxt->input->cur < ctxt->input->end) && (CUR != '>')) {
-        name = htmlParseData(ctxt, MASK_WS_GT, 0, 0, maxLength);
+        name = htmlParseData(ctxt, &MASK_WS_GT, 0, 0, maxLength);
 
         if ((ctxt->options & HTML_PARSE_HTML5) && (name != NULL)) {
             xmlChar *cur;
@@ -4385,16 +4200,8 @@ htmlCtxtParseContentInternal(htmlParserCtxt *ctxt, xmlParserInput *input) {
     return(list);
 }
 
-/**
- * Parse an HTML document and invoke the SAX handlers. This is useful
- * if you're only interested in custom SAX callbacks. If you want a
- * document tree, use #htmlCtxtParseDocument.
- *
- * @param ctxt  an HTML parser context
- * @returns 0, -1 in case of error.
- */
-int
-htmlParseDocument(htmlParserCtxt *ctxt) {
+static int
+htmlParseDocumentInternal(htmlParserCtxt *ctxt) {
     if ((ctxt == NULL) || (ctxt->input == NULL))
 	return(-1);
 
@@ -4478,6 +4285,38 @@ htmlParseDocument(htmlParserCtxt *ctxt) {
     return(0);
 }
 
+/**
+ * Parse an HTML document and invoke the SAX handlers. This is useful
+ * if you're only interested in custom SAX callbacks. If you want a
+ * document tree, use #htmlCtxtParseDocument.
+ *
+ * @param ctxt  an HTML parser context
+ * @returns 0, -1 in case of error.
+ */
+int
+htmlParseDocument(htmlParserCtxt *ctxt) {
+    xmlMemBudget *oldBudget;
+    int res;
+
+    const char *url;
+    double start;
+
+    if ((ctxt == NULL) || (ctxt->input == NULL))
+        return(-1);
+
+    url = ctxt->input->filename;
+    XML_TRACE_BEGIN(doc, XML_TRACE_DOC_START, url, start);
+
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+    res = htmlParseDocumentInternal(ctxt);
+    xmlMemBudgetLeave(oldBudget);
+
+    XML_TRACE_END(doc, XML_TRACE_DOC_END, url, xmlCtxtTraceBytes(ctxt),
+                  start);
+
+    return(res);
+}
+
 
 /************************************************************************
  *									*
@@ -5131,31 +4970,9 @@ htmlParseTryOrFinish(htmlParserCtxtPtr ctxt, int terminate) {
     }
 }
 
-/**
- * Parse a chunk of memory in push parser mode.
- *
- * Assumes that the parser context was initialized with
- * #htmlCreatePushParserCtxt.
- *
- * The last chunk, which will often be empty, must be marked with
- * the `terminate` flag. With the default SAX callbacks, the resulting
- * document will be available in `ctxt->myDoc`. This pointer will not
- * be freed by the library.
- *
- * If the document isn't well-formed, `ctxt->myDoc` is set to NULL.
- *
- * Since 2.14.0, #xmlCtxtGetDocument can be used to retrieve the
- * result document.
- *
- * @param ctxt  an HTML parser context
- * @param chunk  chunk of memory
- * @param size  size of chunk in bytes
- * @param terminate  last chunk indicator
- * @returns an xmlParserErrors code (0 on success).
- */
-int
-htmlParseChunk(htmlParserCtxt *ctxt, const char *chunk, int size,
-              int terminate) {
+static int
+htmlParseChunkInternal(htmlParserCtxt *ctxt, const char *chunk, int size,
+                       int terminate) {
     if ((ctxt == NULL) ||
         (ctxt->input == NULL) || (ctxt->input->buf == NULL) ||
         (size < 0) ||
@@ -5165,11 +4982,16 @@ htmlParseChunk(htmlParserCtxt *ctxt, const char *chunk, int size,
         return(ctxt->errNo);
 
     if (size > 0)  {
-	size_t pos = ctxt->input->cur - ctxt->input->base;
+	size_t pos;
 	int res;
 
+        /* Release parsed input before growing the buffer */
+        xmlParserShrink(ctxt);
+
+	pos = ctxt->input->cur - ctxt->input->base;
 	res = xmlParserInputBufferPush(ctxt->input->buf, size, chunk);
         xmlBufUpdateInput(ctxt->input->buf->buffer, ctxt->input, pos);
+        ctxt->stats.inputGrows++;
 	if (res < 0) {
             htmlParseErr(ctxt, ctxt->input->buf->error,
                          "xmlParserInputBufferPush failed", NULL, NULL);
@@ -5196,6 +5018,52 @@ htmlParseChunk(htmlParserCtxt *ctxt, const char *chunk, int size,
     return((xmlParserErrors) ctxt->errNo);
 }
 
+/**
+ * Parse a chunk of memory in push parser mode.
+ *
+ * Assumes that the parser context was initialized with
+ * #htmlCreatePushParserCtxt.
+ *
+ * The last chunk, which will often be empty, must be marked with
+ * the `terminate` flag. With the default SAX callbacks, the resulting
+ * document will be available in `ctxt->myDoc`. This pointer will not
+ * be freed by the library.
+ *
+ * If the document isn't well-formed, `ctxt->myDoc` is set to NULL.
+ *
+ * Since 2.14.0, #xmlCtxtGetDocument can be used to retrieve the
+ * result document.
+ *
+ * @param ctxt  an HTML parser context
+ * @param chunk  chunk of memory
+ * @param size  size of chunk in bytes
+ * @param terminate  last chunk indicator
+ * @returns an xmlParserErrors code (0 on success).
+ */
+int
+htmlParseChunk(htmlParserCtxt *ctxt, const char *chunk, int size,
+              int terminate) {
+    xmlMemBudget *oldBudget;
+    int res;
+
+    if (ctxt == NULL)
+        return(XML_ERR_ARGUMENT);
+
+    if ((ctxt->instate == XML_PARSER_START) && (ctxt->input != NULL))
+        XML_TRACE_BEGIN(doc, XML_TRACE_DOC_START, ctxt->input->filename,
+                        ctxt->traceStart);
+
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+    res = htmlParseChunkInternal(ctxt, chunk, size, terminate);
+    xmlMemBudgetLeave(oldBudget);
+
+    if ((terminate) && (ctxt->input != NULL))
+        XML_TRACE_END(doc, XML_TRACE_DOC_END, ctxt->input->filename,
+                      xmlCtxtTraceBytes(ctxt), ctxt->traceStart);
+
+    return(res);
+}
+
 /************************************************************************
  *									*
  *			User entry points				*
@@ -6001,4 +5869,954 @@ htmlCtxtReadIO(xmlParserCtxt *ctxt, xmlInputReadCallback ioread,
     return(htmlCtxtParseDocument(ctxt, input));
 }
 
+
+/************************************************************************
+ *									*
+ *			Token streaming					*
+ *									*
+ ************************************************************************/
+
+/*
+ * Flags for htmlTokDecode
+ */
+#define HTML_TOK_REFS       (1 << 0)    /* resolve character references */
+#define HTML_TOK_ATTR       (1 << 1)    /* reference rules of attributes */
+#define HTML_TOK_LOWER      (1 << 2)    /* lowercase ASCII letters */
+#define HTML_TOK_STRIP_NUL  (1 << 3)    /* drop U+0000 */
+
+/*
+ * A string of a token, either a slice of the input or a range of the
+ * scratch buffer. Ranges are only turned into pointers once the
+ * token is complete since the buffer may be reallocated.
+ */
+typedef struct {
+    const xmlChar *str;
+    size_t off;
+    int len;
+} htmlTokString;
+
+struct _htmlTokenizer {
+    const xmlChar *cur;
+    const xmlChar *end;
+
+    /* Data mode after a start tag, see htmlElemDesc */
+    int mode;
+    xmlChar endName[16];
+    int endNameLen;
+
+    /* Scratch buffer for strings that had to be decoded */
+    xmlChar *buf;
+    size_t bufSize;
+    size_t bufUsed;
+
+    /* Attribute names and values, two strings per attribute */
+    htmlTokString *strs;
+    htmlTokenAttr *attrs;
+    int nbAttrs;
+    int maxAttrs;
+
+    int *attrHash;
+    unsigned attrHashSize;
+    unsigned seed;
+};
+
+/**
+ * Create a tokenizer for an HTML document in memory. The tokenizer
+ * follows the HTML5 tokenization rules of the parser but doesn't
+ * construct a tree, so it also doesn't check the nesting of
+ * elements or add implied elements. It switches to the data modes
+ * of elements like script, style, textarea or title after their
+ * start tags.
+ *
+ * The input must be encoded in UTF-8 and must stay valid while the
+ * tokenizer is in use. It isn't checked for invalid UTF-8 sequences.
+ *
+ * @since 2.16.0
+ *
+ * @param buffer  the document
+ * @param size  size of the document in bytes
+ * @returns the tokenizer or NULL if a memory allocation failed or
+ * the arguments are invalid.
+ */
+htmlTokenizer *
+htmlNewTokenizer(const char *buffer, int size) {
+    htmlTokenizer *tok;
+
+    if ((buffer == NULL) || (size < 0))
+        return(NULL);
+
+    xmlInitParser();
+
+    tok = xmlMalloc(sizeof(*tok));
+    if (tok == NULL)
+        return(NULL);
+    memset(tok, 0, sizeof(*tok));
+    tok->cur = BAD_CAST buffer;
+    tok->end = tok->cur + size;
+    tok->seed = xmlRandom();
+
+    return(tok);
+}
+
+/**
+ * Free a tokenizer.
+ *
+ * @since 2.16.0
+ *
+ * @param tok  the tokenizer
+ */
+void
+htmlFreeTokenizer(htmlTokenizer *tok) {
+    if (tok == NULL)
+        return;
+
+    xmlFree(tok->buf);
+    xmlFree(tok->strs);
+    xmlFree(tok->attrs);
+    xmlFree(tok->attrHash);
+    xmlFree(tok);
+}
+
+static int
+htmlTokAppend(htmlTokenizer *tok, const xmlChar *str, size_t len) {
+    /* tok->buf may still be NULL */
+    if (len == 0)
+        return(0);
+
+    if (len > tok->bufSize - tok->bufUsed) {
+        xmlChar *tmp;
+        size_t newSize;
+
+        if (len > SIZE_MAX / 2 - tok->bufUsed)
+            return(-1);
+        newSize = (tok->bufUsed + len) * 2;
+        if (newSize < 256)
+            newSize = 256;
+        tmp = xmlRealloc(tok->buf, newSize);
+        if (tmp == NULL)
+            return(-1);
+        tok->buf = tmp;
+        tok->bufSize = newSize;
+    }
+
+    memcpy(tok->buf + tok->bufUsed, str, len);
+    tok->bufUsed += len;
+    return(0);
+}
+
+/**
+ * Append the expansion of the character reference at `cur` to the
+ * scratch buffer, or a literal '&' if there is no reference.
+ *
+ * @param tok  the tokenizer
+ * @param cur  pointer to '&'
+ * @param end  end of the string
+ * @param isAttr  whether the reference is in an attribute value
+ * @param next  set to the first byte after the reference
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokRef(htmlTokenizer *tok, const xmlChar *cur, const xmlChar *end,
+           int isAttr, const xmlChar **next) {
+    const xmlChar *repl;
+    xmlChar utf8Char[4];
+    size_t avail = end - cur;
+    int replSize;
+
+    if ((avail > 2) && (cur[1] == '#')) {
+        const xmlChar *in = cur + 2;
+        int ncr = 10;
+        int cp = 0;
+
+        if ((*in | 0x20) == 'x') {
+            ncr = 16;
+            in += 1;
+        }
+
+        if ((in < end) &&
+            (((ncr == 10) && (IS_ASCII_DIGIT(*in))) ||
+             ((ncr == 16) && (IS_HEX_DIGIT(*in))))) {
+            while (in < end) {
+                int c = *in;
+                int lc = c | 0x20;
+                int digit;
+
+                if ((c >= '0') && (c <= '9'))
+                    digit = c - '0';
+                else if ((ncr == 16) && (lc >= 'a') && (lc <= 'f'))
+                    digit = (lc - 'a') + 10;
+                else
+                    break;
+
+                cp = cp * ncr + digit;
+                if (cp >= 0x110000)
+                    cp = 0x110000;
+                in += 1;
+            }
+            if ((in < end) && (*in == ';'))
+                in += 1;
+
+            repl = htmlCodePointToUtf8(cp, utf8Char, &replSize);
+            *next = in;
+            return(htmlTokAppend(tok, repl, replSize));
+        }
+    } else if (avail > 1) {
+        int nameSize;
+
+        repl = htmlFindEntityPrefix(cur + 1, avail - 1, isAttr,
+                                    &nameSize, &replSize);
+        if (repl != NULL) {
+            *next = cur + 1 + nameSize;
+            return(htmlTokAppend(tok, repl, replSize));
+        }
+    }
+
+    *next = cur + 1;
+    return(htmlTokAppend(tok, BAD_CAST "&", 1));
+}
+
+#define HTML_TOK_SPECIAL(c, flags) \
+    (((c) == 0) || ((c) == '\r') || \
+     (((c) == '&') && ((flags) & HTML_TOK_REFS)) || \
+     (((flags) & HTML_TOK_LOWER) && (IS_UPPER(c))))
+
+/**
+ * Make a token string from a range of the input. The range itself is
+ * returned unless it contains characters which have to be replaced.
+ * Otherwise, the decoded string is added to the scratch buffer.
+ *
+ * Newlines are always normalized, and U+0000 is replaced with U+FFFD
+ * unless HTML_TOK_STRIP_NUL is set.
+ *
+ * @param tok  the tokenizer
+ * @param start  start of the range
+ * @param end  end of the range
+ * @param flags  HTML_TOK_* flags
+ * @param out  the resulting string
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokDecode(htmlTokenizer *tok, const xmlChar *start, const xmlChar *end,
+              int flags, htmlTokString *out) {
+    const xmlChar *cur = start;
+    const xmlChar *run;
+    size_t off;
+
+    while ((cur < end) && (!HTML_TOK_SPECIAL(*cur, flags)))
+        cur++;
+
+    if (cur >= end) {
+        out->str = start;
+        out->off = 0;
+        out->len = end - start;
+        return(0);
+    }
+
+    off = tok->bufUsed;
+    run = start;
+
+    while (1) {
+        int c;
+
+        while ((cur < end) && (!HTML_TOK_SPECIAL(*cur, flags)))
+            cur++;
+        if (htmlTokAppend(tok, run, cur - run) < 0)
+            return(-1);
+        if (cur >= end)
+            break;
+
+        c = *cur;
+        if (c == 0) {
+            if (((flags & HTML_TOK_STRIP_NUL) == 0) &&
+                (htmlTokAppend(tok, BAD_CAST "\xEF\xBF\xBD", 3) < 0))
+                return(-1);
+            cur += 1;
+        } else if (c == '\r') {
+            if (htmlTokAppend(tok, BAD_CAST "\n", 1) < 0)
+                return(-1);
+            cur += 1;
+            if ((cur < end) && (*cur == '\n'))
+                cur += 1;
+        } else if (c == '&') {
+            if (htmlTokRef(tok, cur, end, (flags & HTML_TOK_ATTR) != 0,
+                           &cur) < 0)
+                return(-1);
+        } else {
+            xmlChar lc = c + 0x20;
+
+            if (htmlTokAppend(tok, &lc, 1) < 0)
+                return(-1);
+            cur += 1;
+        }
+
+        run = cur;
+    }
+
+    if (tok->bufUsed - off > INT_MAX)
+        return(-1);
+
+    out->str = NULL;
+    out->off = off;
+    out->len = tok->bufUsed - off;
+    return(0);
+}
+
+static const xmlChar *
+htmlTokStringPtr(htmlTokenizer *tok, const htmlTokString *str) {
+    if (str->str != NULL)
+        return(str->str);
+    /* only empty strings were decoded so far */
+    if (tok->buf == NULL)
+        return(BAD_CAST "");
+    return(tok->buf + str->off);
+}
+
+static void
+htmlTokSkipBlanks(htmlTokenizer *tok) {
+    while ((tok->cur < tok->end) && (IS_WS_HTML(*tok->cur)))
+        tok->cur++;
+}
+
+/**
+ * Scan a tag or attribute name. The first byte is always part of the
+ * name.
+ *
+ * @param tok  the tokenizer
+ * @param attr  whether this is an attribute name
+ * @param out  the lowercase name
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokName(htmlTokenizer *tok, int attr, htmlTokString *out) {
+    const xmlChar *start = tok->cur;
+    const xmlChar *cur = start + 1;
+
+    while (cur < tok->end) {
+        int c = *cur;
+
+        if ((c == '/') || (c == '>') || (IS_WS_HTML(c)) ||
+            ((attr) && (c == '=')))
+            break;
+        cur++;
+    }
+
+    tok->cur = cur;
+    return(htmlTokDecode(tok, start, cur, HTML_TOK_LOWER, out));
+}
+
+/**
+ * Scan an attribute value after '='.
+ *
+ * @param tok  the tokenizer
+ * @param out  the decoded value
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokAttrValue(htmlTokenizer *tok, htmlTokString *out) {
+    const xmlChar *start, *cur;
+
+    if ((tok->cur < tok->end) &&
+        ((*tok->cur == '"') || (*tok->cur == '\''))) {
+        start = tok->cur + 1;
+        cur = memchr(start, *tok->cur, tok->end - start);
+        if (cur == NULL) {
+            cur = tok->end;
+            tok->cur = cur;
+        } else {
+            tok->cur = cur + 1;
+        }
+    } else {
+        start = tok->cur;
+        cur = start;
+        while ((cur < tok->end) && (*cur != '>') && (!IS_WS_HTML(*cur)))
+            cur++;
+        tok->cur = cur;
+    }
+
+    return(htmlTokDecode(tok, start, cur, HTML_TOK_REFS | HTML_TOK_ATTR,
+                         out));
+}
+
+/**
+ * Check whether attribute `n` has the same name as an earlier
+ * attribute and add it to the hash table otherwise.
+ *
+ * @param tok  the tokenizer
+ * @param n  index of the attribute
+ * @returns 1 if the attribute is a duplicate, 0 otherwise.
+ */
+static int
+htmlTokAttrSeen(htmlTokenizer *tok, int n) {
+    const htmlTokString *name = &tok->strs[n * 2];
+    const xmlChar *str = htmlTokStringPtr(tok, name);
+    xmlHashState hs;
+    unsigned mask = tok->attrHashSize - 1;
+    unsigned i;
+
+    xmlHashInit(&hs, tok->seed);
+    xmlHashUpdateString(&hs, str, name->len);
+    i = xmlHashFinish(&hs) & mask;
+
+    while (tok->attrHash[i] >= 0) {
+        const htmlTokString *other = &tok->strs[tok->attrHash[i] * 2];
+
+        if ((other->len == name->len) &&
+            (memcmp(htmlTokStringPtr(tok, other), str, name->len) == 0))
+            return(1);
+        i = (i + 1) & mask;
+    }
+
+    tok->attrHash[i] = n;
+    return(0);
+}
+
+/**
+ * Drop attributes whose name was already seen and fill the public
+ * attribute array.
+ *
+ * @param tok  the tokenizer
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokFinishAttrs(htmlTokenizer *tok) {
+    int dedup = (tok->nbAttrs > 1);
+    int i, j;
+
+    if (dedup) {
+        unsigned size = 4;
+
+        while (size / 2 < (unsigned) tok->nbAttrs)
+            size *= 2;
+        if (size > tok->attrHashSize) {
+            int *tmp;
+
+            tmp = xmlRealloc(tok->attrHash, size * sizeof(tmp[0]));
+            if (tmp == NULL)
+                return(-1);
+            tok->attrHash = tmp;
+            tok->attrHashSize = size;
+        }
+        memset(tok->attrHash, -1, tok->attrHashSize * sizeof(int));
+    }
+
+    for (i = 0, j = 0; i < tok->nbAttrs; i++) {
+        const htmlTokString *name = &tok->strs[i * 2];
+        const htmlTokString *value = &tok->strs[i * 2 + 1];
+        htmlTokenAttr *attr = &tok->attrs[j];
+
+        if ((dedup) && (htmlTokAttrSeen(tok, i)))
+            continue;
+
+        attr->name = htmlTokStringPtr(tok, name);
+        attr->nameLen = name->len;
+        if (value->len >= 0) {
+            attr->value = htmlTokStringPtr(tok, value);
+            attr->valueLen = value->len;
+        } else {
+            attr->value = NULL;
+            attr->valueLen = 0;
+        }
+        j++;
+    }
+
+    tok->nbAttrs = j;
+    return(0);
+}
+
+/**
+ * Scan the attributes of a start or end tag up to the end of the
+ * tag.
+ *
+ * @param tok  the tokenizer
+ * @param store  whether to store the attributes
+ * @param selfClosing  set if the tag ends with "/>"
+ * @returns 1 if the tag is complete, 0 if the input ended inside the
+ * tag, -1 if a memory allocation failed.
+ */
+static int
+htmlTokAttrs(htmlTokenizer *tok, int store, int *selfClosing) {
+    *selfClosing = 0;
+    tok->nbAttrs = 0;
+
+    while (1) {
+        htmlTokString name, value;
+
+        htmlTokSkipBlanks(tok);
+        if (tok->cur >= tok->end)
+            return(0);
+
+        if (*tok->cur == '>') {
+            tok->cur += 1;
+            return(1);
+        }
+        if (*tok->cur == '/') {
+            tok->cur += 1;
+            if ((tok->cur < tok->end) && (*tok->cur == '>')) {
+                tok->cur += 1;
+                *selfClosing = 1;
+                return(1);
+            }
+            continue;
+        }
+
+        if (htmlTokName(tok, 1, &name) < 0)
+            return(-1);
+
+        value.str = NULL;
+        value.off = 0;
+        value.len = -1;
+        htmlTokSkipBlanks(tok);
+        if ((tok->cur < tok->end) && (*tok->cur == '=')) {
+            tok->cur += 1;
+            htmlTokSkipBlanks(tok);
+            if (htmlTokAttrValue(tok, &value) < 0)
+                return(-1);
+        }
+
+        if (!store)
+            continue;
+
+        if (tok->nbAttrs >= tok->maxAttrs) {
+            htmlTokString *strs;
+            htmlTokenAttr *attrs;
+            int newSize;
+
+            newSize = xmlGrowCapacity(tok->maxAttrs,
+                                      sizeof(strs[0]) * 2 + sizeof(attrs[0]),
+                                      8, HTML_MAX_ATTRS);
+            if (newSize < 0)
+                return(-1);
+            strs = xmlRealloc(tok->strs, newSize * 2 * sizeof(strs[0]));
+            if (strs == NULL)
+                return(-1);
+            tok->strs = strs;
+            attrs = xmlRealloc(tok->attrs, newSize * sizeof(attrs[0]));
+            if (attrs == NULL)
+                return(-1);
+            tok->attrs = attrs;
+            tok->maxAttrs = newSize;
+        }
+
+        tok->strs[tok->nbAttrs * 2] = name;
+        tok->strs[tok->nbAttrs * 2 + 1] = value;
+        tok->nbAttrs += 1;
+    }
+}
+
+/**
+ * Check for an end tag matching the element which started the
+ * current data mode.
+ *
+ * @param tok  the tokenizer
+ * @param in  pointer to the tag name
+ * @returns 1 if the name matches and is followed by a delimiter
+ */
+static int
+htmlTokIsEndName(htmlTokenizer *tok, const xmlChar *in) {
+    int i, c;
+
+    if (tok->end - in <= tok->endNameLen)
+        return(0);
+    for (i = 0; i < tok->endNameLen; i++) {
+        if (tok->endName[i] != (in[i] | 0x20))
+            return(0);
+    }
+    c = in[i];
+    return((c == '>') || (c == '/') || (IS_WS_HTML(c)));
+}
+
+/**
+ * Find the end of text in one of the special data modes, which is
+ * the appropriate end tag or the end of input. Script data is
+ * scanned for escaped sections like in htmlParseCharData.
+ *
+ * @param tok  the tokenizer
+ * @returns a pointer to the end of the text
+ */
+static const xmlChar *
+htmlTokRawTextEnd(htmlTokenizer *tok) {
+    const xmlChar *cur = tok->cur;
+    const xmlChar *end = tok->end;
+    int mode = tok->mode;
+
+    if (mode == DATA_PLAINTEXT)
+        return(end);
+
+    while (cur < end) {
+        const xmlChar *in;
+
+        if (mode == DATA_SCRIPT_ESC1 || mode == DATA_SCRIPT_ESC2) {
+            if (*cur == '-') {
+                if ((end - cur >= 3) && (cur[1] == '-') && (cur[2] == '>'))
+                    mode = DATA_SCRIPT;
+                cur += 1;
+                continue;
+            }
+            if (*cur != '<') {
+                cur += 1;
+                continue;
+            }
+        } else {
+            cur = memchr(cur, '<', end - cur);
+            if (cur == NULL)
+                break;
+        }
+
+        in = cur + 1;
+        if ((mode == DATA_SCRIPT) && (in < end) && (*in == '!')) {
+            if ((end - in >= 3) && (in[1] == '-') && (in[2] == '-'))
+                mode = DATA_SCRIPT_ESC1;
+        } else {
+            int solidus = 0;
+
+            if ((in < end) && (*in == '/')) {
+                in += 1;
+                solidus = 1;
+            }
+
+            if (((solidus) || (mode == DATA_SCRIPT_ESC1)) &&
+                (htmlTokIsEndName(tok, in))) {
+                if ((mode == DATA_SCRIPT_ESC1) && (!solidus))
+                    mode = DATA_SCRIPT_ESC2;
+                else if (mode == DATA_SCRIPT_ESC2)
+                    mode = DATA_SCRIPT_ESC1;
+                else
+                    return(cur);
+            }
+        }
+
+        cur += 1;
+    }
+
+    return(end);
+}
+
+/**
+ * Find the end of text in the normal data mode, which is a '<'
+ * starting a tag, comment or other markup.
+ *
+ * @param tok  the tokenizer
+ * @returns a pointer to the end of the text
+ */
+static const xmlChar *
+htmlTokTextEnd(htmlTokenizer *tok) {
+    const xmlChar *cur = tok->cur;
+    const xmlChar *end = tok->end;
+
+    while (1) {
+        cur = memchr(cur, '<', end - cur);
+        if (cur == NULL)
+            return(end);
+        if (end - cur >= 2) {
+            int c = cur[1];
+
+            if ((IS_ASCII_LETTER(c)) || (c == '/') || (c == '!') ||
+                (c == '?'))
+                return(cur);
+        }
+        cur += 1;
+    }
+}
+
+/**
+ * Scan a comment after "<!--".
+ *
+ * @param tok  the tokenizer
+ * @param start  start of the comment content
+ * @param out  the comment content
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokComment(htmlTokenizer *tok, const xmlChar *start,
+               htmlTokString *out) {
+    const xmlChar *cur = start;
+    const xmlChar *end = tok->end;
+    const xmlChar *stop = start;
+
+    if ((cur < end) && (*cur == '>')) {
+        tok->cur = cur + 1;
+    } else if ((end - cur >= 2) && (cur[0] == '-') && (cur[1] == '>')) {
+        tok->cur = cur + 2;
+    } else {
+        /*
+         * Comments end with "-->" or "--!>". Dashes and "--!" at the
+         * end of input are dropped.
+         */
+        tok->cur = end;
+        stop = end;
+
+        while (cur < end) {
+            size_t avail;
+
+            cur = memchr(cur, '-', end - cur);
+            if (cur == NULL)
+                break;
+            avail = end - cur;
+
+            if (avail < 2) {
+                stop = cur;
+                break;
+            }
+            if (cur[1] == '-') {
+                if (avail < 3) {
+                    stop = cur;
+                    break;
+                }
+                if (cur[2] == '>') {
+                    stop = cur;
+                    tok->cur = cur + 3;
+                    break;
+                }
+                if (cur[2] == '!') {
+                    if (avail < 4) {
+                        stop = cur;
+                        break;
+                    }
+                    if (cur[3] == '>') {
+                        stop = cur;
+                        tok->cur = cur + 4;
+                        break;
+                    }
+                }
+            }
+
+            cur += 1;
+        }
+    }
+
+    return(htmlTokDecode(tok, start, stop, 0, out));
+}
+
+/**
+ * Scan a bogus comment which ends at the next '>'.
+ *
+ * @param tok  the tokenizer
+ * @param start  start of the comment content
+ * @param out  the comment content
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokBogusComment(htmlTokenizer *tok, const xmlChar *start,
+                    htmlTokString *out) {
+    const xmlChar *stop;
+
+    stop = memchr(start, '>', tok->end - start);
+    if (stop == NULL) {
+        stop = tok->end;
+        tok->cur = stop;
+    } else {
+        tok->cur = stop + 1;
+    }
+
+    return(htmlTokDecode(tok, start, stop, 0, out));
+}
+
+/**
+ * Scan a DOCTYPE declaration after "<!DOCTYPE". Only the name is
+ * returned, the rest is skipped.
+ *
+ * @param tok  the tokenizer
+ * @param start  pointer after "<!DOCTYPE"
+ * @param out  the lowercase name
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+htmlTokDoctype(htmlTokenizer *tok, const xmlChar *start,
+               htmlTokString *out) {
+    const xmlChar *name, *cur;
+
+    tok->cur = start;
+    htmlTokSkipBlanks(tok);
+    name = tok->cur;
+    cur = name;
+    while ((cur < tok->end) && (*cur != '>') && (!IS_WS_HTML(*cur)))
+        cur++;
+
+    if (htmlTokDecode(tok, name, cur, HTML_TOK_LOWER, out) < 0)
+        return(-1);
+
+    cur = memchr(cur, '>', tok->end - cur);
+    tok->cur = (cur != NULL) ? cur + 1 : tok->end;
+    return(0);
+}
+
+/**
+ * Return the next token from the input.
+ *
+ * Strings in the token point into the input unless they had to be
+ * modified. Tag, attribute and DOCTYPE names are lowercased,
+ * newlines are normalized and character references in text and
+ * attribute values are resolved. U+0000 is dropped from normal text
+ * and replaced with U+FFFD elsewhere. Modified strings are stored in
+ * a buffer owned by the tokenizer. All strings stay valid until the
+ * next call.
+ *
+ * Duplicate attributes are dropped. Tags which are cut off by the
+ * end of input are ignored. Text may be returned in multiple
+ * consecutive tokens.
+ *
+ * @since 2.16.0
+ *
+ * @param tok  the tokenizer
+ * @param token  the resulting token
+ * @returns 1 if a token was returned, 0 at the end of input or -1 if
+ * a memory allocation failed or the arguments are invalid.
+ */
+int
+htmlTokenizerNext(htmlTokenizer *tok, htmlToken *token) {
+    const xmlChar *end;
+    htmlTokString str;
+
+    if (token == NULL)
+        return(-1);
+    memset(token, 0, sizeof(*token));
+    if (tok == NULL)
+        return(-1);
+
+    tok->bufUsed = 0;
+    tok->nbAttrs = 0;
+    end = tok->end;
+
+    while (tok->cur < end) {
+        const xmlChar *cur = tok->cur;
+        const xmlChar *stop;
+        int selfClosing;
+        int res, c;
+
+        if (tok->mode != 0) {
+            int flags = (tok->mode == DATA_RCDATA) ? HTML_TOK_REFS : 0;
+
+            stop = htmlTokRawTextEnd(tok);
+            if (tok->mode != DATA_PLAINTEXT)
+                tok->mode = 0;
+            tok->cur = stop;
+            if (stop == cur)
+                continue;
+
+            if (htmlTokDecode(tok, cur, stop, flags, &str) < 0)
+                return(-1);
+            token->type = HTML_TOKEN_TEXT;
+            goto done;
+        }
+
+        if ((*cur != '<') || (end - cur < 2)) {
+            stop = htmlTokTextEnd(tok);
+            tok->cur = stop;
+
+            if (htmlTokDecode(tok, cur, stop,
+                              HTML_TOK_REFS | HTML_TOK_STRIP_NUL,
+                              &str) < 0)
+                return(-1);
+            if (str.len == 0)
+                continue;
+            token->type = HTML_TOKEN_TEXT;
+            goto done;
+        }
+
+        c = cur[1];
+
+        if (IS_ASCII_LETTER(c)) {
+            const htmlElemDesc *info;
+            const xmlChar *name;
+
+            tok->cur = cur + 1;
+            if (htmlTokName(tok, 0, &str) < 0)
+                return(-1);
+            res = htmlTokAttrs(tok, 1, &selfClosing);
+            if (res < 0)
+                return(-1);
+            if (res == 0)
+                continue;
+            if (htmlTokFinishAttrs(tok) < 0)
+                return(-1);
+
+            token->type = HTML_TOKEN_START_TAG;
+            token->selfClosing = selfClosing;
+            if (tok->nbAttrs > 0) {
+                token->attrs = tok->attrs;
+                token->nbAttrs = tok->nbAttrs;
+            }
+
+            name = htmlTokStringPtr(tok, &str);
+            if ((!selfClosing) && (str.len < (int) sizeof(tok->endName))) {
+                memcpy(tok->endName, name, str.len);
+                tok->endName[str.len] = 0;
+                info = htmlTagLookup(tok->endName);
+                if ((info != NULL) && (info->dataMode != 0)) {
+                    tok->mode = info->dataMode;
+                    tok->endNameLen = str.len;
+                }
+            }
+            goto done;
+        }
+
+        if (c == '/') {
+            if (end - cur < 3) {
+                tok->cur = end;
+                str.str = cur;
+                str.len = end - cur;
+                token->type = HTML_TOKEN_TEXT;
+                goto done;
+            }
+
+            c = cur[2];
+            if (c == '>') {
+                tok->cur = cur + 3;
+                continue;
+            }
+
+            if (!IS_ASCII_LETTER(c)) {
+                if (htmlTokBogusComment(tok, cur + 2, &str) < 0)
+                    return(-1);
+                token->type = HTML_TOKEN_COMMENT;
+                goto done;
+            }
+
+            tok->cur = cur + 2;
+            if (htmlTokName(tok, 0, &str) < 0)
+                return(-1);
+            res = htmlTokAttrs(tok, 0, &selfClosing);
+            if (res < 0)
+                return(-1);
+            if (res == 0)
+                continue;
+
+            token->type = HTML_TOKEN_END_TAG;
+            goto done;
+        }
+
+        if (c == '!') {
+            if ((end - cur >= 4) && (cur[2] == '-') && (cur[3] == '-')) {
+                if (htmlTokComment(tok, cur + 4, &str) < 0)
+                    return(-1);
+                token->type = HTML_TOKEN_COMMENT;
+            } else if ((end - cur >= 9) &&
+                       (xmlStrncasecmp(cur + 2, BAD_CAST "DOCTYPE", 7) == 0)) {
+                if (htmlTokDoctype(tok, cur + 9, &str) < 0)
+                    return(-1);
+                token->type = HTML_TOKEN_DOCTYPE;
+            } else {
+                if (htmlTokBogusComment(tok, cur + 2, &str) < 0)
+                    return(-1);
+                token->type = HTML_TOKEN_COMMENT;
+            }
+            goto done;
+        }
+
+        /* '?' */
+        if (htmlTokBogusComment(tok, cur + 1, &str) < 0)
+            return(-1);
+        token->type = HTML_TOKEN_COMMENT;
+        goto done;
+    }
+
+    token->type = HTML_TOKEN_EOF;
+    return(0);
+
+done:
+    token->data = htmlTokStringPtr(tok, &str);
+    token->len = str.len;
+    return(1);
+}
+
 #endif /* LIBXML_HTML_ENABLED */
@@ -29,6 +29,7 @@
 #include "private/html.h"
 #include "private/io.h"
 #include "private/save.h"
+#include "private/simd.h"
 #include "private/tree.h"
 
 /************************************************************************
@@ -695,6 +696,9 @@ htmlDtdDumpOutput(xmlOutputBufferPtr buf, xmlDocPtr doc,
 static void
 htmlSerializeUri(xmlOutputBufferPtr buf, const xmlChar *content) {
     const xmlChar *tmp = content;
+#ifdef XML_SIMD_ENABLED
+    const xmlChar *end;
+#endif
 
     /*
      * See appendix "B.2.1 Non-ASCII characters in URI attribute
@@ -711,12 +715,22 @@ htmlSerializeUri(xmlOutputBufferPtr buf, const xmlChar *content) {
         content = tmp;
     }
 
+#ifdef XML_SIMD_ENABLED
+    end = tmp + strlen((const char *) tmp);
+#endif
+
     while (1) {
         char escbuf[3];
         const char *repl;
         int replSize;
-        int c = *tmp;
+        int c;
+
+#ifdef XML_SIMD_ENABLED
+        if (end - tmp >= 16)
+            tmp = xmlScanUri(tmp, end);
+#endif
 
+        c = *tmp;
         while ((c > 0x20) && (c < 0x7F) && (c != '"') && (c != '&')) {
             tmp += 1;
             c = *tmp;
@@ -817,6 +831,34 @@ htmlAttrDumpOutput(xmlOutputBufferPtr buf, xmlAttrPtr cur) {
     }
 }
 
+#define HTML_DESC_CACHE_SIZE 32
+
+typedef struct {
+    const xmlChar *name;
+    const htmlElemDesc *info;
+} htmlDescCacheEntry;
+
+/*
+ * Element names are mostly interned in the document dictionary, so
+ * a small table keyed by the name pointer saves the binary search in
+ * htmlTagLookup for nearly all start and end tags.
+ */
+static const htmlElemDesc *
+htmlCachedTagLookup(htmlDescCacheEntry *cache, const xmlChar *name) {
+    htmlDescCacheEntry *entry;
+
+    if (name == NULL)
+        return(NULL);
+
+    entry = &cache[((size_t) name >> 4) % HTML_DESC_CACHE_SIZE];
+    if (entry->name != name) {
+        entry->name = name;
+        entry->info = htmlTagLookup(name);
+    }
+
+    return(entry->info);
+}
+
 /**
  * Serialize an HTML node to an output buffer.
  *
@@ -834,6 +876,7 @@ htmlNodeDumpInternal(xmlOutputBuffer *buf, xmlNode *cur,
     xmlNodePtr root, parent, metaHead = NULL;
     xmlAttrPtr attr;
     const htmlElemDesc * info;
+    htmlDescCacheEntry descCache[HTML_DESC_CACHE_SIZE];
     int isRaw = 0;
 
     xmlInitParser();
@@ -842,6 +885,8 @@ htmlNodeDumpInternal(xmlOutputBuffer *buf, xmlNode *cur,
 	return;
     }
 
+    memset(descCache, 0, sizeof(descCache));
+
     root = cur;
     parent = cur->parent;
     while (1) {
@@ -882,7 +927,7 @@ htmlNodeDumpInternal(xmlOutputBuffer *buf, xmlNode *cur,
              * Get specific HTML info for that node.
              */
             if (cur->ns == NULL)
-                info = htmlTagLookup(cur->name);
+                info = htmlCachedTagLookup(descCache, cur->name);
             else
                 info = NULL;
 
@@ -1078,7 +1123,7 @@ htmlNodeDumpInternal(xmlOutputBuffer *buf, xmlNode *cur,
                 xmlOutputBufferWrite(buf, 1, "\n");
             } else {
                 if ((format) && (cur->ns == NULL))
-                    info = htmlTagLookup(cur->name);
+                    info = htmlCachedTagLookup(descCache, cur->name);
                 else
                     info = NULL;
 
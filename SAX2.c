@@ -27,6 +27,7 @@
 #include <libxml/HTMLtree.h>
 
 #include "private/error.h"
+#include "private/memory.h"
 #include "private/parser.h"
 #include "private/tree.h"
 
@@ -169,6 +170,7 @@ xmlSAX2GetLineNumber(void *ctx)
 {
     xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
     if ((ctx == NULL) || (ctxt->input == NULL)) return(0);
+    xmlParserInputSyncLines(ctxt->input);
     return(ctxt->input->line);
 }
 
@@ -183,6 +185,7 @@ xmlSAX2GetColumnNumber(void *ctx)
 {
     xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
     if ((ctx == NULL) || (ctxt->input == NULL)) return(0);
+    xmlParserInputSyncLines(ctxt->input);
     return(ctxt->input->col);
 }
 
@@ -287,6 +290,7 @@ xmlSAX2ExternalSubset(void *ctx, const xmlChar *name,
 	xmlParserInputPtr *oldinputTab;
 	xmlParserInputPtr input = NULL;
 	xmlChar *oldencoding;
+        xmlDtdPtr shared;
         unsigned long consumed;
         size_t buffered;
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
@@ -295,6 +299,15 @@ xmlSAX2ExternalSubset(void *ctx, const xmlChar *name,
         int inputMax = 5;
 #endif
 
+	/*
+	 * Use a shared DTD if one was registered
+	 */
+        shared = xmlDtdCacheLookup(ctxt, publicId, systemId);
+        if (shared != NULL) {
+            ctxt->myDoc->extSubset = shared;
+            return;
+        }
+
 	/*
 	 * Ask the Entity resolver to load the damn thing
 	 */
@@ -824,6 +837,11 @@ xmlSAX2StartDocument(void *ctx)
 	    doc->dict = ctxt->dict;
 	    xmlDictReference(doc->dict);
 	}
+        if (ctxt->options & XML_PARSE_ARENA) {
+            doc->arena = xmlArenaCreate();
+            if (doc->arena == NULL)
+                xmlSAX2ErrMemory(ctxt);
+        }
     }
     if ((ctxt->myDoc != NULL) && (ctxt->myDoc->URL == NULL) &&
 	(ctxt->input != NULL) && (ctxt->input->filename != NULL)) {
@@ -831,6 +849,8 @@ xmlSAX2StartDocument(void *ctx)
 	if (ctxt->myDoc->URL == NULL)
 	    xmlSAX2ErrMemory(ctxt);
     }
+    if (xmlCtxtStartFilter(ctxt) < 0)
+        xmlSAX2ErrMemory(ctxt);
 }
 
 /**
@@ -838,6 +858,16 @@ xmlSAX2StartDocument(void *ctx)
  *
  * @param ctx  the user data (XML parser context)
  */
+static void
+xmlSAX2EndTextSink(xmlParserCtxtPtr ctxt) {
+    xmlNodePtr node = ctxt->textSinkNode;
+
+    ctxt->textSinkNode = NULL;
+    if ((ctxt->textSink != NULL) &&
+        (ctxt->textSink(ctxt->textSinkData, node, BAD_CAST "", 0, 0) < 0))
+        xmlStopParser(ctxt);
+}
+
 void
 xmlSAX2EndDocument(void *ctx)
 {
@@ -845,6 +875,9 @@ xmlSAX2EndDocument(void *ctx)
     xmlDocPtr doc;
 
     if (ctx == NULL) return;
+    /* Text of unfinished elements after errors */
+    if (ctxt->textSinkNode != NULL)
+        xmlSAX2EndTextSink(ctxt);
 #ifdef LIBXML_VALID_ENABLED
     if (ctxt->validate && ctxt->wellFormed &&
         ctxt->myDoc && ctxt->myDoc->intSubset)
@@ -891,6 +924,42 @@ xmlSAX2EndDocument(void *ctx)
     }
 }
 
+/*
+ * Called when text can no longer be merged into the last child of the
+ * current node. xmlSAX2Text grows merged content geometrically, give
+ * back the unused part of the buffer once instead of keeping up to
+ * twice the needed memory in the tree.
+ *
+ * @param ctxt  the parser context
+ */
+static void
+xmlSAX2FinishText(xmlParserCtxtPtr ctxt) {
+    xmlNodePtr text;
+    xmlChar *content;
+    int unused;
+
+    if ((ctxt->textSinkNode != NULL) && (ctxt->node != NULL) &&
+        (ctxt->node->last == ctxt->textSinkNode))
+        xmlSAX2EndTextSink(ctxt);
+
+    if ((ctxt->node != NULL) && (ctxt->nodemem > 0)) {
+        text = ctxt->node->last;
+        unused = ctxt->nodemem - (ctxt->nodelen + 1);
+
+        if ((text != NULL) && (text->content != NULL) &&
+            ((text->type == XML_TEXT_NODE) ||
+             (text->type == XML_CDATA_SECTION_NODE)) &&
+            (unused >= 64) && (unused > ctxt->nodelen / 8)) {
+            content = xmlRealloc(text->content, ctxt->nodelen + 1);
+            /* Keep the larger buffer if shrinking fails */
+            if (content != NULL)
+                text->content = content;
+        }
+    }
+
+    ctxt->nodemem = -1;
+}
+
 static void
 xmlSAX2AppendChild(xmlParserCtxtPtr ctxt, xmlNodePtr node) {
     xmlNodePtr parent;
@@ -901,6 +970,7 @@ xmlSAX2AppendChild(xmlParserCtxtPtr ctxt, xmlNodePtr node) {
     } else if (ctxt->inSubset == 2) {
 	parent = (xmlNodePtr) ctxt->myDoc->extSubset;
     } else {
+        xmlSAX2FinishText(ctxt);
         parent = ctxt->node;
         if (parent == NULL)
             parent = (xmlNodePtr) ctxt->myDoc;
@@ -916,9 +986,11 @@ xmlSAX2AppendChild(xmlParserCtxtPtr ctxt, xmlNodePtr node) {
 
     parent->last = node;
     node->parent = parent;
+    ctxt->stats.nodes++;
 
     if ((node->type != XML_TEXT_NODE) &&
 	(ctxt->input != NULL)) {
+        xmlParserInputSyncLines(ctxt->input);
         if ((unsigned) ctxt->input->line < (unsigned) USHRT_MAX)
             node->line = ctxt->input->line;
         else
@@ -926,6 +998,25 @@ xmlSAX2AppendChild(xmlParserCtxtPtr ctxt, xmlNodePtr node) {
     }
 }
 
+/**
+ * Register an ID attribute. With lazy IDs, the attribute is only
+ * marked and added to the ID table by the first lookup.
+ *
+ * @param ctxt  the parser context
+ * @param value  the ID value
+ * @param attr  the attribute
+ */
+static void
+xmlSAX2AddID(xmlParserCtxtPtr ctxt, const xmlChar *value, xmlAttrPtr attr) {
+    if ((ctxt->lazyIds) && (ctxt->parseMode != XML_PARSE_READER)) {
+        attr->atype = XML_ATTRIBUTE_ID;
+        ctxt->myDoc->properties |= XML_DOC_LAZY_IDS;
+        return;
+    }
+
+    xmlAddID(&ctxt->vctxt, ctxt->myDoc, value, attr);
+}
+
 #if defined(LIBXML_SAX1_ENABLED)
 /**
  * Handle a namespace error
@@ -1015,6 +1106,8 @@ xmlSAX1Attribute(xmlParserCtxtPtr ctxt, const xmlChar *fullname,
 
 	/* a default namespace definition */
 	nsret = xmlNewNs(ctxt->node, val, NULL);
+        if (nsret != NULL)
+            ctxt->stats.namespaces++;
         if (nsret == NULL) {
             xmlSAX2ErrMemory(ctxt);
         }
@@ -1077,6 +1170,8 @@ xmlSAX1Attribute(xmlParserCtxtPtr ctxt, const xmlChar *fullname,
 	/* a standard namespace definition */
 	nsret = xmlNewNs(ctxt->node, val, name);
 	xmlFree(ns);
+        if (nsret != NULL)
+            ctxt->stats.namespaces++;
 
         if (nsret == NULL) {
             xmlSAX2ErrMemory(ctxt);
@@ -1138,6 +1233,7 @@ xmlSAX1Attribute(xmlParserCtxtPtr ctxt, const xmlChar *fullname,
         xmlSAX2ErrMemory(ctxt);
         goto error;
     }
+    ctxt->stats.attributes++;
 
     if (ctxt->replaceEntities == 0) {
         if (xmlNodeParseAttValue(ret->doc, ret, value, SIZE_MAX, NULL) < 0)
@@ -1228,14 +1324,14 @@ xmlSAX1Attribute(xmlParserCtxtPtr ctxt, const xmlChar *fullname,
 		         "xml:id : attribute value %s is not an NCName\n",
 		         content);
 	    }
-	    xmlAddID(&ctxt->vctxt, ctxt->myDoc, content, ret);
+	    xmlSAX2AddID(ctxt, content, ret);
 	} else {
             int res = xmlIsID(ctxt->myDoc, ctxt->node, ret);
 
             if (res < 0)
                 xmlCtxtErrMemory(ctxt);
             else if (res > 0)
-                xmlAddID(&ctxt->vctxt, ctxt->myDoc, content, ret);
+                xmlSAX2AddID(ctxt, content, ret);
             else if (xmlIsRef(ctxt->myDoc, ctxt->node, ret))
                 xmlAddRef(&ctxt->vctxt, ctxt->myDoc, content, ret);
         }
@@ -1468,7 +1564,7 @@ xmlSAX1StartElement(void *ctx, const xmlChar *fullname, const xmlChar **atts)
 	xmlSAX2ErrMemory(ctxt);
         return;
     }
-    ctxt->nodemem = -1;
+    xmlSAX2FinishText(ctxt);
 
     /* Initialize parent before pushing node */
     parent = ctxt->node;
@@ -1603,6 +1699,7 @@ xmlSAX2HtmlAttribute(xmlParserCtxtPtr ctxt, const xmlChar *fullname,
         xmlSAX2ErrMemory(ctxt);
         return;
     }
+    ctxt->stats.attributes++;
 
     if ((value == NULL) && (htmlIsBooleanAttr(fullname))) {
         nval = xmlStrdup(fullname);
@@ -1636,7 +1733,7 @@ xmlSAX2HtmlAttribute(xmlParserCtxtPtr ctxt, const xmlChar *fullname,
         if (res < 0)
             xmlCtxtErrMemory(ctxt);
         else if (res > 0)
-            xmlAddID(&ctxt->vctxt, ctxt->myDoc, ret->children->content, ret);
+            xmlSAX2AddID(ctxt, ret->children->content, ret);
     }
 
     if (nval != NULL)
@@ -1664,7 +1761,7 @@ xmlSAX2StartHtmlElement(xmlParserCtxtPtr ctxt, const xmlChar *fullname,
 	xmlSAX2ErrMemory(ctxt);
         return;
     }
-    ctxt->nodemem = -1;
+    xmlSAX2FinishText(ctxt);
 
     /* Initialize parent before pushing node */
     parent = ctxt->node;
@@ -1759,7 +1856,7 @@ xmlSAX2EndElement(void *ctx, const xmlChar *name ATTRIBUTE_UNUSED)
 #endif /* LIBXML_VALID_ENABLED */
 
 #if defined(LIBXML_SAX1_ENABLED) || defined(LIBXML_HTML_ENABLED)
-    ctxt->nodemem = -1;
+    xmlSAX2FinishText(ctxt);
 
     /*
      * end of parsing of this node.
@@ -1771,6 +1868,8 @@ xmlSAX2EndElement(void *ctx, const xmlChar *name ATTRIBUTE_UNUSED)
 /*
  * @param ctxt  the parser context
  * @param doc  the document
+ * @param mem  memory for the node followed by room for `len + 1`
+ *             bytes of content (optional)
  * @param str  the input string
  * @param len  the string length
  *
@@ -1779,20 +1878,22 @@ xmlSAX2EndElement(void *ctx, const xmlChar *name ATTRIBUTE_UNUSED)
  * @returns the newly allocated string or NULL if not needed or error
  */
 static xmlNodePtr
-xmlSAX2TextNode(xmlParserCtxtPtr ctxt, xmlDocPtr doc, const xmlChar *str,
-                int len) {
+xmlSAX2TextNode(xmlParserCtxtPtr ctxt, xmlDocPtr doc, xmlNodePtr mem,
+                const xmlChar *str, int len) {
     xmlNodePtr ret;
     const xmlChar *intern = NULL;
 
     /*
      * Allocate
      */
-    if (ctxt->freeElems != NULL) {
+    if (mem != NULL) {
+        ret = mem;
+    } else if (ctxt->freeElems != NULL) {
 	ret = ctxt->freeElems;
 	ctxt->freeElems = ret->next;
 	ctxt->freeElemsNr--;
     } else {
-	ret = (xmlNodePtr) xmlMalloc(sizeof(xmlNode));
+	ret = (xmlNodePtr) xmlTreeAlloc(doc, sizeof(xmlNode));
     }
     if (ret == NULL) {
         xmlCtxtErrMemory(ctxt);
@@ -1818,7 +1919,7 @@ xmlSAX2TextNode(xmlParserCtxtPtr ctxt, xmlDocPtr doc, const xmlChar *str,
 	    intern = xmlDictLookup(ctxt->dict, str, len);
             if (intern == NULL) {
                 xmlSAX2ErrMemory(ctxt);
-                xmlFree(ret);
+                xmlTreeFree(doc, ret);
                 return(NULL);
             }
 	} else if (IS_BLANK_CH(*str) && (len < 60) && (cur == '<') &&
@@ -1831,7 +1932,7 @@ xmlSAX2TextNode(xmlParserCtxtPtr ctxt, xmlDocPtr doc, const xmlChar *str,
 	    intern = xmlDictLookup(ctxt->dict, str, len);
             if (intern == NULL) {
                 xmlSAX2ErrMemory(ctxt);
-                xmlFree(ret);
+                xmlTreeFree(doc, ret);
                 return(NULL);
             }
 	}
@@ -1841,11 +1942,15 @@ skip:
     ret->doc = doc;
 
     ret->name = xmlStringText;
-    if (intern == NULL) {
-	ret->content = xmlStrndup(str, len);
+    if ((intern == NULL) && (mem != NULL)) {
+        ret->content = (xmlChar *) (mem + 1);
+        memcpy(ret->content, str, len);
+        ret->content[len] = 0;
+    } else if (intern == NULL) {
+	ret->content = xmlTreeStrndup(doc, str, len);
 	if (ret->content == NULL) {
 	    xmlSAX2ErrMemory(ctxt);
-	    xmlFree(ret);
+	    xmlTreeFree(doc, ret);
 	    return(NULL);
 	}
     } else
@@ -1907,6 +2012,7 @@ xmlSAX2AttributeNs(xmlParserCtxtPtr ctxt,
 		   const xmlChar * valueend)
 {
     xmlAttrPtr ret;
+    xmlNodePtr textMem = NULL;
     xmlNsPtr namespace = NULL;
     xmlChar *dup = NULL;
 
@@ -1931,8 +2037,24 @@ xmlSAX2AttributeNs(xmlParserCtxtPtr ctxt,
         ret = ctxt->freeAttrs;
 	ctxt->freeAttrs = ret->next;
 	ctxt->freeAttrsNr--;
+    } else if ((ctxt->node->doc != NULL) &&
+               (ctxt->node->doc->arena != NULL) && (value != NULL) &&
+               ((ctxt->replaceEntities) || (ctxt->html) ||
+                (*valueend != 0))) {
+        /*
+         * The value becomes a single text child. Allocate the
+         * attribute, the text node and its content in one block.
+         */
+        ret = xmlArenaAlloc(ctxt->node->doc->arena,
+                            sizeof(xmlAttr) + sizeof(xmlNode) +
+                            (valueend - value) + 1);
+        if (ret == NULL) {
+            xmlSAX2ErrMemory(ctxt);
+            return(NULL);
+        }
+        textMem = (xmlNodePtr) (ret + 1);
     } else {
-        ret = xmlMalloc(sizeof(*ret));
+        ret = xmlTreeAlloc(ctxt->node->doc, sizeof(*ret));
         if (ret == NULL) {
             xmlSAX2ErrMemory(ctxt);
             return(NULL);
@@ -1941,6 +2063,7 @@ xmlSAX2AttributeNs(xmlParserCtxtPtr ctxt,
 
     memset(ret, 0, sizeof(xmlAttr));
     ret->type = XML_ATTRIBUTE_NODE;
+    ctxt->stats.attributes++;
 
     /*
      * xmlParseBalancedChunkMemoryRecover had a bug that could result in
@@ -1975,7 +2098,8 @@ xmlSAX2AttributeNs(xmlParserCtxtPtr ctxt,
 	 * otherwise with ' or "
 	 */
 	if (*valueend != 0) {
-	    tmp = xmlSAX2TextNode(ctxt, ret->doc, value, valueend - value);
+	    tmp = xmlSAX2TextNode(ctxt, ret->doc, textMem, value,
+                                  valueend - value);
 	    ret->children = tmp;
 	    ret->last = tmp;
 	    if (tmp != NULL) {
@@ -1989,7 +2113,8 @@ xmlSAX2AttributeNs(xmlParserCtxtPtr ctxt,
     } else if (value != NULL) {
 	xmlNodePtr tmp;
 
-	tmp = xmlSAX2TextNode(ctxt, ret->doc, value, valueend - value);
+	tmp = xmlSAX2TextNode(ctxt, ret->doc, textMem, value,
+                              valueend - value);
 	ret->children = tmp;
 	ret->last = tmp;
 	if (tmp != NULL) {
@@ -2108,14 +2233,14 @@ xmlSAX2AttributeNs(xmlParserCtxtPtr ctxt,
                          "xml:id : attribute value %s is not an NCName\n",
                          content);
 	    }
-	    xmlAddID(&ctxt->vctxt, ctxt->myDoc, content, ret);
+	    xmlSAX2AddID(ctxt, content, ret);
 	} else {
             int res = xmlIsID(ctxt->myDoc, ctxt->node, ret);
 
             if (res < 0)
                 xmlCtxtErrMemory(ctxt);
             else if (res > 0)
-                xmlAddID(&ctxt->vctxt, ctxt->myDoc, content, ret);
+                xmlSAX2AddID(ctxt, content, ret);
             else if (xmlIsRef(ctxt->myDoc, ctxt->node, ret))
                 xmlAddRef(&ctxt->vctxt, ctxt->myDoc, content, ret);
 	}
@@ -2162,6 +2287,27 @@ xmlSAX2StartElementNs(void *ctx,
 
     if (ctx == NULL) return;
 
+    /*
+     * With a pattern filter, elements outside of selected subtrees
+     * are only built as ancestors, without attributes.
+     */
+    if (ctxt->filterStreams != NULL) {
+        if (ctxt->filterDepth > 0) {
+            ctxt->filterDepth++;
+        } else {
+            int match = xmlCtxtFilterPush(ctxt, localname, URI);
+
+            if (match < 0) {
+                xmlSAX2ErrMemory(ctxt);
+                return;
+            }
+            if (match)
+                ctxt->filterDepth = 1;
+            else
+                nb_attributes = 0;
+        }
+    }
+
 #ifdef LIBXML_VALID_ENABLED
     /*
      * First check on validity:
@@ -2249,6 +2395,8 @@ xmlSAX2StartElementNs(void *ctx,
 	uri = namespaces[i++];
 	ns = xmlNewNs(NULL, uri, pref);
 	if (ns != NULL) {
+            xmlDictNsId(ctxt->dict, uri, 1);
+            ctxt->stats.namespaces++;
 	    if (last == NULL) {
 	        ret->nsDef = last = ns;
 	    } else {
@@ -2272,7 +2420,7 @@ xmlSAX2StartElementNs(void *ctx,
 	}
 #endif /* LIBXML_VALID_ENABLED */
     }
-    ctxt->nodemem = -1;
+    xmlSAX2FinishText(ctxt);
 
     /*
      * Link the child element
@@ -2420,9 +2568,10 @@ xmlSAX2EndElementNs(void *ctx,
 		    const xmlChar * URI ATTRIBUTE_UNUSED)
 {
     xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlNodePtr cur;
 
     if (ctx == NULL) return;
-    ctxt->nodemem = -1;
+    xmlSAX2FinishText(ctxt);
 
 #ifdef LIBXML_VALID_ENABLED
     if (ctxt->validate && ctxt->wellFormed &&
@@ -2434,7 +2583,22 @@ xmlSAX2EndElementNs(void *ctx,
     /*
      * end of parsing of this node.
      */
-    nodePop(ctxt);
+    cur = nodePop(ctxt);
+
+    if (ctxt->filterStreams != NULL) {
+        if (ctxt->filterDepth > 1) {
+            ctxt->filterDepth--;
+        } else {
+            /* Ancestors without selected descendants are dropped */
+            if ((ctxt->filterDepth == 0) && (cur != NULL) &&
+                (cur->children == NULL) && (ctxt->node != NULL)) {
+                xmlUnlinkNode(cur);
+                xmlFreeNode(cur);
+            }
+            ctxt->filterDepth = 0;
+            xmlCtxtFilterPop(ctxt);
+        }
+    }
 }
 
 /**
@@ -2450,6 +2614,7 @@ xmlSAX2Reference(void *ctx, const xmlChar *name)
     xmlNodePtr ret;
 
     if (ctx == NULL) return;
+    if (PARSER_FILTERED(ctxt)) return;
     ret = xmlNewReference(ctxt->myDoc, name);
     if (ret == NULL) {
         xmlSAX2ErrMemory(ctxt);
@@ -2459,6 +2624,31 @@ xmlSAX2Reference(void *ctx, const xmlChar *name)
     xmlSAX2AppendChild(ctxt, ret);
 }
 
+/*
+ * Pass the content of a text node to the text sink and leave the node
+ * empty. Further text merged into the node goes to the sink as well.
+ */
+static void
+xmlSAX2StartTextSink(xmlParserCtxtPtr ctxt, xmlNodePtr node) {
+    xmlChar *content = node->content;
+
+    if (ctxt->textSink(ctxt->textSinkData, node, content, ctxt->nodelen,
+                       1) < 0) {
+        xmlStopParser(ctxt);
+        return;
+    }
+
+    if ((content != (xmlChar *) &node->properties) &&
+        (!xmlDictOwns(ctxt->dict, content)) &&
+        ((node->doc == NULL) || (!xmlArenaOwns(node->doc->arena, content))))
+        xmlFree(content);
+    node->properties = NULL;
+    node->content = (xmlChar *) &node->properties;
+    ctxt->nodelen = 0;
+    ctxt->nodemem = 1;
+    ctxt->textSinkNode = node;
+}
+
 /**
  * Append characters.
  *
@@ -2473,12 +2663,13 @@ xmlSAX2Text(xmlParserCtxtPtr ctxt, const xmlChar *ch, int len,
 {
     xmlNodePtr lastChild;
     xmlNodePtr parent;
+    int merge;
 
     if (ctxt == NULL)
         return;
 
     parent = ctxt->node;
-    if (parent == NULL)
+    if ((parent == NULL) || (PARSER_FILTERED(ctxt)))
         return;
     lastChild = parent->last;
 
@@ -2486,16 +2677,26 @@ xmlSAX2Text(xmlParserCtxtPtr ctxt, const xmlChar *ch, int len,
      * Try to merge with previous text node using size and capacity
      * stored in the parser context to avoid naive concatenation.
      *
-     * Don't merge CDATA sections. In HTML mode, CDATA is used for
-     * raw text which should be merged.
+     * Don't merge CDATA sections unless they were reported in
+     * chunks. In HTML mode, CDATA is used for raw text which should
+     * be merged.
      */
-    if ((lastChild == NULL) ||
-        (lastChild->type != type) ||
-        ((!ctxt->html) && (type != XML_TEXT_NODE))) {
+    merge = (lastChild != NULL) &&
+            (lastChild->type == type) &&
+            ((ctxt->html) || (type == XML_TEXT_NODE) ||
+             (ctxt->partialText & XML_TEXT_CONTINUED));
+
+    if ((merge) && (lastChild == ctxt->textSinkNode)) {
+        if (ctxt->textSink(ctxt->textSinkData, lastChild, ch, len, 1) < 0)
+            xmlStopParser(ctxt);
+        return;
+    }
+
+    if (!merge) {
         xmlNode *node;
 
         if (type == XML_TEXT_NODE)
-            node = xmlSAX2TextNode(ctxt, parent->doc, ch, len);
+            node = xmlSAX2TextNode(ctxt, parent->doc, NULL, ch, len);
         else
             node = xmlNewCDataBlock(parent->doc, ch, len);
 	if (node == NULL) {
@@ -2507,6 +2708,7 @@ xmlSAX2Text(xmlParserCtxtPtr ctxt, const xmlChar *ch, int len,
             parent->children = node;
             parent->last = node;
             node->parent = parent;
+            ctxt->stats.nodes++;
         } else {
             xmlSAX2AppendChild(ctxt, node);
         }
@@ -2547,12 +2749,14 @@ xmlSAX2Text(xmlParserCtxtPtr ctxt, const xmlChar *ch, int len,
                 capacity = newSize > INT_MAX / 2 ? INT_MAX : newSize * 2;
 
             /*
-             * If the content was stored in properties or in
-             * the dictionary, don't realloc.
+             * If the content was stored in properties, in the
+             * dictionary or in the document's arena, don't realloc.
              */
             if ((content == (xmlChar *) &lastChild->properties) ||
                 ((ctxt->nodemem == oldSize + 1) &&
-                 (xmlDictOwns(ctxt->dict, content)))) {
+                 ((xmlDictOwns(ctxt->dict, content)) ||
+                  ((lastChild->doc != NULL) &&
+                   (xmlArenaOwns(lastChild->doc->arena, content)))))) {
                 xmlChar *newContent;
 
                 newContent = xmlMalloc(capacity);
@@ -2581,9 +2785,17 @@ xmlSAX2Text(xmlParserCtxtPtr ctxt, const xmlChar *ch, int len,
         ctxt->nodelen = newSize;
     }
 
+    if ((ctxt->textSink != NULL) &&
+        (ctxt->nodelen > ctxt->textSinkThreshold)) {
+        xmlSAX2StartTextSink(ctxt, lastChild);
+        if (PARSER_STOPPED(ctxt))
+            return;
+    }
+
     if ((lastChild != NULL) &&
         (type == XML_TEXT_NODE) &&
         (ctxt->input != NULL)) {
+        xmlParserInputSyncLines(ctxt->input);
         if ((unsigned) ctxt->input->line < (unsigned) USHRT_MAX)
             lastChild->line = ctxt->input->line;
         else {
@@ -2635,6 +2847,7 @@ xmlSAX2ProcessingInstruction(void *ctx, const xmlChar *target,
     xmlNodePtr ret;
 
     if (ctx == NULL) return;
+    if (PARSER_FILTERED(ctxt)) return;
 
     ret = xmlNewDocPI(ctxt->myDoc, target, data);
     if (ret == NULL) {
@@ -2658,6 +2871,7 @@ xmlSAX2Comment(void *ctx, const xmlChar *value)
     xmlNodePtr ret;
 
     if (ctx == NULL) return;
+    if (PARSER_FILTERED(ctxt)) return;
 
     ret = xmlNewDocComment(ctxt->myDoc, value);
     if (ret == NULL) {
@@ -22,10 +22,15 @@
 #include <libxml/xmlerror.h>
 #include <libxml/xpathInternals.h>
 #include <libxml/c14n.h>
+#ifdef LIBXML_READER_ENABLED
+#include <libxml/xmlreader.h>
+#endif
 
+#include "private/dict.h"
 #include "private/error.h"
 #include "private/io.h"
 #include "private/memory.h"
+#include "private/tree.h"
 
 /************************************************************************
  *									*
@@ -39,6 +44,17 @@ typedef enum {
     XMLC14N_AFTER_DOCUMENT_ELEMENT = 2
 } xmlC14NPosition;
 
+/*
+ * A distinct prefix seen on the visible namespace stack. Entries with
+ * the same prefix are chained through prevTab, so the topmost one is
+ * found without scanning the stack.
+ */
+typedef struct _xmlC14NNsPrefix {
+    xmlChar *prefix;        /* copy of the prefix, "" for the default namespace */
+    unsigned hash;          /* hash value of the prefix */
+    int top;                /* topmost stack entry with this prefix or -1 */
+} xmlC14NNsPrefix;
+
 typedef struct _xmlC14NVisibleNsStack {
     int nsCurEnd;           /* number of nodes in the set */
     int nsPrevStart;        /* the beginning of the stack for previous visible node */
@@ -46,8 +62,28 @@ typedef struct _xmlC14NVisibleNsStack {
     int nsMax;              /* size of the array as allocated */
     xmlNsPtr	*nsTab;	    /* array of ns in no particular order */
     xmlNodePtr	*nodeTab;   /* array of nodes in no particular order */
+    int *prefixIdTab;       /* index of each entry's prefix in prefixTab */
+    int *prevTab;           /* previous entry with the same prefix or -1 */
+    xmlC14NNsPrefix *prefixTab; /* distinct prefixes */
+    int prefixNr;           /* number of distinct prefixes */
+    int prefixMax;          /* size of prefixTab as allocated */
+    int *hashTab;           /* open addressing table of prefixTab indices */
+    int hashSize;           /* size of hashTab, a power of two */
 } xmlC14NVisibleNsStack, *xmlC14NVisibleNsStackPtr;
 
+/*
+ * Sort key of an attribute or namespace node, precomputed once per
+ * element so that comparisons don't chase node pointers
+ */
+typedef struct _xmlC14NSortKey {
+    const void *item;       /* the attribute or namespace node */
+    const xmlNs *ns;        /* namespace of an attribute */
+    const xmlChar *href;    /* namespace URI of an attribute */
+    const xmlChar *name;    /* local name of an attribute or ns prefix */
+    int hrefId;             /* interned ID of href */
+    int index;              /* insertion order */
+} xmlC14NSortKey;
+
 typedef struct _xmlC14NCtx {
     /* input parameters */
     xmlDocPtr doc;
@@ -67,10 +103,27 @@ typedef struct _xmlC14NCtx {
     /* exclusive canonicalization */
     xmlChar **inclusive_ns_prefixes;
 
+    /* sort keys of the current element, reused between elements */
+    xmlC14NSortKey *sortTab;
+    int sortNr;
+    int sortMax;
+
+    /* namespace URI IDs of the sort keys */
+    xmlNsIdCache nsIds;
+
     /* error number */
     int error;
 } xmlC14NCtx, *xmlC14NCtxPtr;
 
+/*
+ * An open element when elements are processed without recursion
+ */
+typedef struct _xmlC14NElemFrame {
+    xmlC14NVisibleNsStack state;    /* saved by xmlC14NStartElement */
+    int parent_is_doc;
+    int visible;
+} xmlC14NElemFrame;
+
 static xmlC14NVisibleNsStackPtr	xmlC14NVisibleNsStackCreate	(void);
 static void     xmlC14NVisibleNsStackDestroy	(xmlC14NVisibleNsStackPtr cur);
 static int      xmlC14NVisibleNsStackAdd	    (xmlC14NVisibleNsStackPtr cur,
@@ -91,6 +144,19 @@ static int			xmlC14NIsNodeInNodeset		(void *user_data,
 								 xmlNodePtr node,
 								 xmlNodePtr parent);
 
+/*
+ * Hash index of a node-set, used instead of linear scans for larger
+ * sets. Namespace nodes in node-sets are copies and are hashed by
+ * their parent element.
+ */
+#define XML_C14N_INDEX_MIN		16
+
+typedef struct _xmlC14NNodeSetIndex {
+    xmlNodeSetPtr nodes;
+    int *tab;               /* open addressing table of node index + 1 */
+    int size;               /* size of the table, a power of two */
+} xmlC14NNodeSetIndex, *xmlC14NNodeSetIndexPtr;
+
 
 
 static int xmlC14NProcessNode(xmlC14NCtxPtr ctx, xmlNodePtr cur);
@@ -268,6 +334,108 @@ xmlC14NIsNodeInNodeset(void *user_data, xmlNodePtr node, xmlNodePtr parent) {
     return(1);
 }
 
+static unsigned
+xmlC14NNodeSetHash(xmlC14NNodeSetIndexPtr idx, xmlNodePtr node) {
+    size_t v;
+    unsigned i;
+
+    if (node->type == XML_NAMESPACE_DECL)
+        v = (size_t) ((xmlNsPtr) node)->next;
+    else
+        v = (size_t) node;
+    i = (unsigned) ((v >> 4) ^ (v >> 20)) * 2654435761u;
+    return((i ^ (i >> 16)) & (idx->size - 1));
+}
+
+/*
+ * Same test as xmlXPathNodeSetContains for a single node.
+ */
+static int
+xmlC14NNodeSetMatch(xmlNodePtr node, xmlNodePtr cur) {
+    if (node->type == XML_NAMESPACE_DECL) {
+        xmlNsPtr ns1 = (xmlNsPtr) node;
+        xmlNsPtr ns2 = (xmlNsPtr) cur;
+
+        if (cur->type != XML_NAMESPACE_DECL)
+            return(0);
+        if (ns1 == ns2)
+            return(1);
+        return((ns1->next != NULL) && (ns2->next == ns1->next) &&
+               (xmlStrEqual(ns1->prefix, ns2->prefix)));
+    }
+    return(node == cur);
+}
+
+static int
+xmlC14NNodeSetIndexFind(xmlC14NNodeSetIndexPtr idx, xmlNodePtr node) {
+    unsigned i = xmlC14NNodeSetHash(idx, node);
+
+    while (idx->tab[i] != 0) {
+        if (xmlC14NNodeSetMatch(node, idx->nodes->nodeTab[idx->tab[i] - 1]))
+            return(1);
+        i = (i + 1) & (idx->size - 1);
+    }
+    return(0);
+}
+
+static int
+xmlC14NNodeSetIndexBuild(xmlC14NNodeSetIndexPtr idx, xmlNodeSetPtr nodes) {
+    int size = 16;
+    int i;
+
+    while (size < nodes->nodeNr * 2) {
+        if (size > XML_MAX_ITEMS)
+            return(-1);
+        size *= 2;
+    }
+    idx->tab = xmlMalloc(size * sizeof(idx->tab[0]));
+    if (idx->tab == NULL)
+        return(-1);
+    memset(idx->tab, 0, size * sizeof(idx->tab[0]));
+    idx->size = size;
+    idx->nodes = nodes;
+
+    for (i = 0; i < nodes->nodeNr; i++) {
+        xmlNodePtr node = nodes->nodeTab[i];
+        unsigned h;
+
+        if (node == NULL)
+            continue;
+        h = xmlC14NNodeSetHash(idx, node);
+        while (idx->tab[h] != 0) {
+            if (xmlC14NNodeSetMatch(node, nodes->nodeTab[idx->tab[h] - 1]))
+                break;
+            h = (h + 1) & (size - 1);
+        }
+        if (idx->tab[h] == 0)
+            idx->tab[h] = i + 1;
+    }
+
+    return(0);
+}
+
+/*
+ * Like xmlC14NIsNodeInNodeset with a node-set index.
+ */
+static int
+xmlC14NIsNodeInNodeSetIndex(void *user_data, xmlNodePtr node,
+                            xmlNodePtr parent) {
+    xmlC14NNodeSetIndexPtr idx = (xmlC14NNodeSetIndexPtr) user_data;
+    xmlNs ns;
+
+    if (node == NULL)
+        return(1);
+    if (node->type != XML_NAMESPACE_DECL)
+        return(xmlC14NNodeSetIndexFind(idx, node));
+
+    memcpy(&ns, node, sizeof(ns));
+    if ((parent != NULL) && (parent->type == XML_ATTRIBUTE_NODE))
+        ns.next = (xmlNsPtr) parent->parent;
+    else
+        ns.next = (xmlNsPtr) parent;
+    return(xmlC14NNodeSetIndexFind(idx, (xmlNodePtr) &ns));
+}
+
 static xmlC14NVisibleNsStackPtr
 xmlC14NVisibleNsStackCreate(void) {
     xmlC14NVisibleNsStackPtr ret;
@@ -293,13 +461,115 @@ xmlC14NVisibleNsStackDestroy(xmlC14NVisibleNsStackPtr cur) {
 	memset(cur->nodeTab, 0, cur->nsMax * sizeof(xmlNodePtr));
 	xmlFree(cur->nodeTab);
     }
+    xmlFree(cur->prefixIdTab);
+    xmlFree(cur->prevTab);
+    if (cur->prefixTab != NULL) {
+        int i;
+
+        for (i = 0; i < cur->prefixNr; i++)
+            xmlFree(cur->prefixTab[i].prefix);
+        xmlFree(cur->prefixTab);
+    }
+    xmlFree(cur->hashTab);
     memset(cur, 0, sizeof(xmlC14NVisibleNsStack));
     xmlFree(cur);
 
 }
 
+/**
+ * Looks up a prefix in the prefix table of the visible stack,
+ * optionally adding it.
+ *
+ * @param cur  		the visible stack
+ * @param prefix  		the prefix, "" for the default namespace
+ * @param create  		add the prefix if it wasn't found
+ * @returns the index of the prefix in prefixTab or -1 if it wasn't
+ * found or a memory allocation failed.
+ */
+static int
+xmlC14NVisibleNsStackLookup(xmlC14NVisibleNsStackPtr cur,
+                            const xmlChar *prefix, int create) {
+    xmlHashState st;
+    unsigned hash;
+    int i, id;
+
+    xmlHashInit(&st, 0);
+    xmlHashUpdateString(&st, prefix, SIZE_MAX);
+    hash = xmlHashFinish(&st);
+
+    if (cur->hashSize > 0) {
+        i = hash & (cur->hashSize - 1);
+        while ((id = cur->hashTab[i]) >= 0) {
+            if ((cur->prefixTab[id].hash == hash) &&
+                (xmlStrEqual(cur->prefixTab[id].prefix, prefix)))
+                return(id);
+            i = (i + 1) & (cur->hashSize - 1);
+        }
+    }
+    if (!create)
+        return(-1);
+
+    if (cur->prefixNr >= cur->prefixMax) {
+        xmlC14NNsPrefix *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(cur->prefixMax, sizeof(tmp[0]),
+                                  XML_NAMESPACES_DEFAULT, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(cur->prefixTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        cur->prefixTab = tmp;
+        cur->prefixMax = newSize;
+    }
+
+    /* Keep the hash table at most half full */
+    if ((cur->prefixNr + 1) * 2 > cur->hashSize) {
+        int *tmp;
+        int newSize;
+
+        newSize = (cur->hashSize > 0) ? cur->hashSize * 2 : 16;
+        tmp = xmlMalloc(newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        for (i = 0; i < newSize; i++)
+            tmp[i] = -1;
+        for (id = 0; id < cur->prefixNr; id++) {
+            i = cur->prefixTab[id].hash & (newSize - 1);
+            while (tmp[i] >= 0)
+                i = (i + 1) & (newSize - 1);
+            tmp[i] = id;
+        }
+        xmlFree(cur->hashTab);
+        cur->hashTab = tmp;
+        cur->hashSize = newSize;
+    }
+
+    /*
+     * The prefix is copied, namespace nodes don't outlive their element
+     * when canonicalizing from a reader.
+     */
+    id = cur->prefixNr;
+    cur->prefixTab[id].prefix = xmlStrdup(prefix);
+    if (cur->prefixTab[id].prefix == NULL)
+        return(-1);
+    cur->prefixNr++;
+    cur->prefixTab[id].hash = hash;
+    cur->prefixTab[id].top = -1;
+    i = hash & (cur->hashSize - 1);
+    while (cur->hashTab[i] >= 0)
+        i = (i + 1) & (cur->hashSize - 1);
+    cur->hashTab[i] = id;
+
+    return(id);
+}
+
 static int
 xmlC14NVisibleNsStackAdd(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns, xmlNodePtr node) {
+    const xmlChar *prefix;
+    int id;
+
     if((cur == NULL) ||
        ((cur->nsTab == NULL) && (cur->nodeTab != NULL)) ||
        ((cur->nsTab != NULL) && (cur->nodeTab == NULL)))
@@ -308,10 +578,12 @@ xmlC14NVisibleNsStackAdd(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns, xmlNodePtr n
     if (cur->nsMax <= cur->nsCurEnd) {
 	xmlNsPtr *tmp1;
         xmlNodePtr *tmp2;
+        int *tmp3, *tmp4;
 	int newSize;
 
         newSize = xmlGrowCapacity(cur->nsMax,
-                                  sizeof(tmp1[0]) + sizeof(tmp2[0]),
+                                  sizeof(tmp1[0]) + sizeof(tmp2[0]) +
+                                  sizeof(tmp3[0]) + sizeof(tmp4[0]),
                                   XML_NAMESPACES_DEFAULT, XML_MAX_ITEMS);
 
 	tmp1 = xmlRealloc(cur->nsTab, newSize * sizeof(tmp1[0]));
@@ -324,10 +596,29 @@ xmlC14NVisibleNsStackAdd(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns, xmlNodePtr n
 	    return (-1);
 	cur->nodeTab = tmp2;
 
+	tmp3 = xmlRealloc(cur->prefixIdTab, newSize * sizeof(tmp3[0]));
+	if (tmp3 == NULL)
+	    return (-1);
+	cur->prefixIdTab = tmp3;
+
+	tmp4 = xmlRealloc(cur->prevTab, newSize * sizeof(tmp4[0]));
+	if (tmp4 == NULL)
+	    return (-1);
+	cur->prevTab = tmp4;
+
 	cur->nsMax = newSize;
     }
+
+    prefix = ((ns == NULL) || (ns->prefix == NULL)) ? BAD_CAST "" : ns->prefix;
+    id = xmlC14NVisibleNsStackLookup(cur, prefix, 1);
+    if (id < 0)
+        return (-1);
+
     cur->nsTab[cur->nsCurEnd] = ns;
     cur->nodeTab[cur->nsCurEnd] = node;
+    cur->prefixIdTab[cur->nsCurEnd] = id;
+    cur->prevTab[cur->nsCurEnd] = cur->prefixTab[id].top;
+    cur->prefixTab[id].top = cur->nsCurEnd;
 
     ++cur->nsCurEnd;
 
@@ -348,10 +639,17 @@ xmlC14NVisibleNsStackSave(xmlC14NVisibleNsStackPtr cur, xmlC14NVisibleNsStackPtr
 
 static void
 xmlC14NVisibleNsStackRestore(xmlC14NVisibleNsStackPtr cur, xmlC14NVisibleNsStackPtr state) {
+    int i;
+
     if((cur == NULL) || (state == NULL)) {
         xmlC14NErrParam(NULL);
 	return;
     }
+
+    /* Unlink the popped entries from their prefix chains */
+    for (i = cur->nsCurEnd - 1; i >= state->nsCurEnd; i--)
+        cur->prefixTab[cur->prefixIdTab[i]].top = cur->prevTab[i];
+
     cur->nsCurEnd = state->nsCurEnd;
     cur->nsPrevStart = state->nsPrevStart;
     cur->nsPrevEnd = state->nsPrevEnd;
@@ -378,6 +676,15 @@ xmlC14NStrEqual(const xmlChar *str1, const xmlChar *str2) {
     return(1);
 }
 
+/*
+ * Compare the URIs of two namespaces.
+ */
+static int
+xmlC14NNsHrefEqual(const xmlNs *ns1, const xmlNs *ns2) {
+    return(xmlC14NStrEqual((ns1 != NULL) ? ns1->href : NULL,
+                           (ns2 != NULL) ? ns2->href : NULL));
+}
+
 /**
  * Checks whether the given namespace was already rendered or not
  *
@@ -388,7 +695,7 @@ xmlC14NStrEqual(const xmlChar *str1, const xmlChar *str2) {
 static int
 xmlC14NVisibleNsStackFind(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns)
 {
-    int i;
+    int i, id;
     const xmlChar *prefix;
     const xmlChar *href;
     int has_empty_ns;
@@ -406,14 +713,19 @@ xmlC14NVisibleNsStackFind(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns)
     href = ((ns == NULL) || (ns->href == NULL)) ? BAD_CAST "" : ns->href;
     has_empty_ns = (xmlC14NStrEqual(prefix, NULL) && xmlC14NStrEqual(href, NULL));
 
-    if (cur->nsTab != NULL) {
+    /*
+     * Only the topmost entry with a matching prefix matters, and only
+     * if it lies above the start of the searched range.
+     */
+    id = xmlC14NVisibleNsStackLookup(cur, prefix, 0);
+    if (id >= 0) {
 	int start = (has_empty_ns) ? 0 : cur->nsPrevStart;
-        for (i = cur->nsCurEnd - 1; i >= start; --i) {
+
+        i = cur->prefixTab[id].top;
+        if (i >= start) {
             xmlNsPtr ns1 = cur->nsTab[i];
 
-	    if(xmlC14NStrEqual(prefix, (ns1 != NULL) ? ns1->prefix : NULL)) {
-		return(xmlC14NStrEqual(href, (ns1 != NULL) ? ns1->href : NULL));
-	    }
+	    return(xmlC14NNsHrefEqual(ns, ns1));
         }
     }
     return(has_empty_ns);
@@ -421,7 +733,7 @@ xmlC14NVisibleNsStackFind(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns)
 
 static int
 xmlExcC14NVisibleNsStackFind(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns, xmlC14NCtxPtr ctx) {
-    int i;
+    int i, id;
     const xmlChar *prefix;
     const xmlChar *href;
     int has_empty_ns;
@@ -439,17 +751,16 @@ xmlExcC14NVisibleNsStackFind(xmlC14NVisibleNsStackPtr cur, xmlNsPtr ns, xmlC14NC
     href = ((ns == NULL) || (ns->href == NULL)) ? BAD_CAST "" : ns->href;
     has_empty_ns = (xmlC14NStrEqual(prefix, NULL) && xmlC14NStrEqual(href, NULL));
 
-    if (cur->nsTab != NULL) {
-	int start = 0;
-        for (i = cur->nsCurEnd - 1; i >= start; --i) {
+    id = xmlC14NVisibleNsStackLookup(cur, prefix, 0);
+    if (id >= 0) {
+        i = cur->prefixTab[id].top;
+        if (i >= 0) {
             xmlNsPtr ns1 = cur->nsTab[i];
 
-	    if(xmlC14NStrEqual(prefix, (ns1 != NULL) ? ns1->prefix : NULL)) {
-		if(xmlC14NStrEqual(href, (ns1 != NULL) ? ns1->href : NULL)) {
-		    return(xmlC14NIsVisible(ctx, ns1, cur->nodeTab[i]));
-		} else {
-		    return(0);
-		}
+	    if(xmlC14NNsHrefEqual(ns, ns1)) {
+		return(xmlC14NIsVisible(ctx, ns1, cur->nodeTab[i]));
+	    } else {
+		return(0);
 	    }
         }
     }
@@ -477,28 +788,219 @@ xmlC14NIsXmlNs(xmlNsPtr ns)
 }
 
 
+/**
+ * Appends an attribute or namespace node to the sort keys of the
+ * current element.
+ *
+ * @param ctx  		the C14N context
+ * @param item  		the attribute or namespace node
+ * @param ns  			the namespace of an attribute or NULL
+ * @param name  		the attribute local name or namespace prefix
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+static int
+xmlC14NSortAdd(xmlC14NCtxPtr ctx, const void *item, const xmlNs *ns,
+               const xmlChar *name)
+{
+    xmlC14NSortKey *key;
+
+    if (ctx->sortNr >= ctx->sortMax) {
+        xmlC14NSortKey *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(ctx->sortMax, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return (-1);
+        tmp = xmlRealloc(ctx->sortTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return (-1);
+        ctx->sortTab = tmp;
+        ctx->sortMax = newSize;
+    }
+
+    key = &ctx->sortTab[ctx->sortNr];
+    key->item = item;
+    key->ns = ns;
+    key->href = (ns != NULL) ? ns->href : NULL;
+    key->hrefId = (ns != NULL) ? xmlNsIdCacheGet(&ctx->nsIds, ns) : 0;
+    key->name = name;
+    key->index = ctx->sortNr++;
+    return (0);
+}
+
+static int
+xmlC14NSortAddNs(xmlC14NCtxPtr ctx, const xmlNs *ns)
+{
+    return (xmlC14NSortAdd(ctx, ns, NULL, ns->prefix));
+}
+
+static int
+xmlC14NSortAddAttr(xmlC14NCtxPtr ctx, const xmlAttr *attr)
+{
+    return (xmlC14NSortAdd(ctx, attr, attr->ns, attr->name));
+}
+
 /**
  * Compares the namespaces by names (prefixes).
  *
- * @param data1  		the pointer to first namespace
- * @param data2  		the pointer to second namespace
+ * @param key1  		the sort key of the first namespace
+ * @param key2  		the sort key of the second namespace
  * @returns -1 if ns1 < ns2, 0 if ns1 == ns2 or 1 if ns1 > ns2.
  */
 static int
-xmlC14NNsCompare(const void *data1, const void *data2)
+xmlC14NNsCompare(const xmlC14NSortKey *key1, const xmlC14NSortKey *key2)
 {
-    const xmlNs *ns1 = data1;
-    const xmlNs *ns2 = data2;
-    if (ns1 == ns2)
+    if ((key1->item == key2->item) || (key1->name == key2->name))
         return (0);
-    if (ns1 == NULL)
+
+    return (xmlStrcmp(key1->name, key2->name));
+}
+
+/**
+ * Compares the attributes by namespace URI and local name.
+ *
+ * @param key1  		the sort key of the first attribute
+ * @param key2  		the sort key of the second attribute
+ * @returns -1 if attr1 < attr2, 0 if attr1 == attr2 or 1 if attr1 > attr2.
+ */
+static int
+xmlC14NAttrsCompare(const xmlC14NSortKey *key1, const xmlC14NSortKey *key2)
+{
+    int ret = 0;
+
+    /*
+     * Simple cases
+     */
+    if (key1->item == key2->item)
+        return (0);
+    if (key1->ns == key2->ns) {
+        if (key1->name == key2->name)
+            return (0);
+        return (xmlStrcmp(key1->name, key2->name));
+    }
+
+    /*
+     * Attributes in the default namespace are first
+     * because the default namespace is not applied to
+     * unqualified attributes
+     */
+    if (key1->ns == NULL)
+        return (-1);
+    if (key2->ns == NULL)
+        return (1);
+    if (key1->ns->prefix == NULL)
         return (-1);
-    if (ns2 == NULL)
+    if (key2->ns->prefix == NULL)
         return (1);
 
-    return (xmlStrcmp(ns1->prefix, ns2->prefix));
+    if ((xmlNsIdCompare(key1->hrefId, key2->hrefId) == 1) ||
+        (key1->href == key2->href))
+        ret = 0;
+    else
+        ret = xmlStrcmp(key1->href, key2->href);
+    if ((ret == 0) && (key1->name != key2->name)) {
+        ret = xmlStrcmp(key1->name, key2->name);
+    }
+    return (ret);
+}
+
+/**
+ * Checks whether an attribute equal to `attr` was already collected.
+ *
+ * @param ctx  		the C14N context
+ * @param attr  		the attribute
+ * @returns 1 if found or 0 otherwise.
+ */
+static int
+xmlC14NSortHasAttr(xmlC14NCtxPtr ctx, const xmlAttr *attr)
+{
+    xmlC14NSortKey key;
+    int i;
+
+    key.item = attr;
+    key.ns = attr->ns;
+    key.href = (attr->ns != NULL) ? attr->ns->href : NULL;
+    key.hrefId = (attr->ns != NULL) ?
+                 xmlNsIdCacheGet(&ctx->nsIds, attr->ns) : 0;
+    key.name = attr->name;
+    key.index = -1;
+
+    for (i = 0; i < ctx->sortNr; i++) {
+        if (xmlC14NAttrsCompare(&ctx->sortTab[i], &key) == 0)
+            return (1);
+    }
+    return (0);
 }
 
+typedef int (*xmlC14NSortCompare)(const xmlC14NSortKey *key1,
+                                  const xmlC14NSortKey *key2);
+
+static int
+xmlC14NNsQsortCompare(const void *data1, const void *data2)
+{
+    const xmlC14NSortKey *key1 = data1;
+    const xmlC14NSortKey *key2 = data2;
+    int ret = xmlC14NNsCompare(key1, key2);
+
+    /* equal keys in reverse insertion order, like the list they replace */
+    if (ret == 0)
+        ret = key2->index - key1->index;
+    return (ret);
+}
+
+static int
+xmlC14NAttrsQsortCompare(const void *data1, const void *data2)
+{
+    const xmlC14NSortKey *key1 = data1;
+    const xmlC14NSortKey *key2 = data2;
+    int ret = xmlC14NAttrsCompare(key1, key2);
+
+    if (ret == 0)
+        ret = key2->index - key1->index;
+    return (ret);
+}
+
+#define XML_C14N_SORT_SMALL 16
+
+/**
+ * Sorts the keys of the current element. Nodes usually come in
+ * document order which is often canonical already, so this is
+ * checked first. Small arrays are insertion sorted. Equal keys
+ * end up in reverse insertion order in both cases.
+ *
+ * @param ctx  		the C14N context
+ * @param compare  		the key comparison
+ * @param qcompare  		the same comparison for qsort
+ */
+static void
+xmlC14NSortKeys(xmlC14NCtxPtr ctx, xmlC14NSortCompare compare,
+                int (*qcompare)(const void *, const void *))
+{
+    xmlC14NSortKey *tab = ctx->sortTab;
+    int nr = ctx->sortNr;
+    int i, j;
+
+    for (i = 1; i < nr; i++) {
+        if (compare(&tab[i - 1], &tab[i]) >= 0)
+            break;
+    }
+    if (i >= nr)
+        return;
+
+    if (nr > XML_C14N_SORT_SMALL) {
+        qsort(tab, nr, sizeof(tab[0]), qcompare);
+        return;
+    }
+
+    for (; i < nr; i++) {
+        xmlC14NSortKey key = tab[i];
+
+        for (j = i; (j > 0) && (compare(&tab[j - 1], &key) >= 0); j--)
+            tab[j] = tab[j - 1];
+        tab[j] = key;
+    }
+}
 
 /**
  * Prints the given namespace to the output buffer from C14N context.
@@ -531,9 +1033,21 @@ xmlC14NPrintNamespaces(const xmlNs *ns, xmlC14NCtxPtr ctx)
     return (1);
 }
 
-static int
-xmlC14NPrintNamespacesWalker(const void *ns, void *ctx) {
-    return xmlC14NPrintNamespaces(ns, ctx);
+/**
+ * Prints the sorted namespaces of the current element.
+ *
+ * @param ctx  		the C14N context
+ */
+static void
+xmlC14NPrintSortedNamespaces(xmlC14NCtxPtr ctx)
+{
+    int i;
+
+    xmlC14NSortKeys(ctx, xmlC14NNsCompare, xmlC14NNsQsortCompare);
+    for (i = 0; i < ctx->sortNr; i++) {
+        if (!xmlC14NPrintNamespaces(ctx->sortTab[i].item, ctx))
+            break;
+    }
 }
 
 /**
@@ -579,7 +1093,6 @@ xmlC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
 {
     xmlNodePtr n;
     xmlNsPtr ns, tmp;
-    xmlListPtr list;
     int already_rendered;
     int has_empty_ns = 0;
 
@@ -589,13 +1102,9 @@ xmlC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
     }
 
     /*
-     * Create a sorted list to store element namespaces
+     * Collect the sort keys of element namespaces
      */
-    list = xmlListCreate(NULL, xmlC14NNsCompare);
-    if (list == NULL) {
-        xmlC14NErrMemory(ctx);
-        return (-1);
-    }
+    ctx->sortNr = 0;
 
     /* check all namespaces */
     for(n = cur; n != NULL; n = n->parent) {
@@ -610,8 +1119,9 @@ xmlC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
                         goto error;
                     }
 		}
-		if(!already_rendered) {
-		    xmlListInsert(list, ns);
+		if((!already_rendered) && (xmlC14NSortAddNs(ctx, ns) < 0)) {
+                    xmlC14NErrMemory(ctx);
+                    goto error;
 		}
 		if(xmlStrlen(ns->prefix) == 0) {
 		    has_empty_ns = 1;
@@ -640,15 +1150,11 @@ xmlC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
 
 
     /*
-     * print out all elements from list
+     * print out all namespaces in canonical order
      */
-    xmlListWalk(list, xmlC14NPrintNamespacesWalker, (void *) ctx);
+    xmlC14NPrintSortedNamespaces(ctx);
 
-    /*
-     * Cleanup
-     */
 error:
-    xmlListDelete(list);
     return (0);
 }
 
@@ -686,7 +1192,6 @@ static int
 xmlExcC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
 {
     xmlNsPtr ns;
-    xmlListPtr list;
     xmlAttrPtr attr;
     int already_rendered;
     int has_empty_ns = 0;
@@ -705,13 +1210,9 @@ xmlExcC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
     }
 
     /*
-     * Create a sorted list to store element namespaces
+     * Collect the sort keys of element namespaces
      */
-    list = xmlListCreate(NULL, xmlC14NNsCompare);
-    if (list == NULL) {
-        xmlC14NErrMemory(ctx);
-        return (-1);
-    }
+    ctx->sortNr = 0;
 
     /*
      * process inclusive namespaces:
@@ -742,8 +1243,9 @@ xmlExcC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
                         goto error;
                     }
 		}
-		if(!already_rendered) {
-		    xmlListInsert(list, ns);
+		if((!already_rendered) && (xmlC14NSortAddNs(ctx, ns) < 0)) {
+                    xmlC14NErrMemory(ctx);
+                    goto error;
 		}
 		if(xmlStrlen(ns->prefix) == 0) {
 		    has_empty_ns = 1;
@@ -761,8 +1263,10 @@ xmlExcC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
     }
     if((ns != NULL) && !xmlC14NIsXmlNs(ns)) {
 	if(visible && xmlC14NIsVisible(ctx, ns, cur)) {
-	    if(!xmlExcC14NVisibleNsStackFind(ctx->ns_rendered, ns, ctx)) {
-		xmlListInsert(list, ns);
+	    if((!xmlExcC14NVisibleNsStackFind(ctx->ns_rendered, ns, ctx)) &&
+               (xmlC14NSortAddNs(ctx, ns) < 0)) {
+                xmlC14NErrMemory(ctx);
+                goto error;
 	    }
 	}
 	if(visible) {
@@ -790,8 +1294,10 @@ xmlExcC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
                 xmlC14NErrMemory(ctx);
                 goto error;
             }
-	    if(!already_rendered && visible) {
-		xmlListInsert(list, attr->ns);
+	    if(!already_rendered && visible &&
+               (xmlC14NSortAddNs(ctx, attr->ns) < 0)) {
+                xmlC14NErrMemory(ctx);
+                goto error;
 	    }
 	    if(xmlStrlen(attr->ns->prefix) == 0) {
 		has_empty_ns = 1;
@@ -826,15 +1332,11 @@ xmlExcC14NProcessNamespacesAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
 
 
     /*
-     * print out all elements from list
+     * print out all namespaces in canonical order
      */
-    xmlListWalk(list, xmlC14NPrintNamespacesWalker, (void *) ctx);
+    xmlC14NPrintSortedNamespaces(ctx);
 
-    /*
-     * Cleanup
-     */
 error:
-    xmlListDelete(list);
     return (0);
 }
 
@@ -856,55 +1358,6 @@ xmlC14NIsXmlAttr(xmlAttrPtr attr)
 }
 
 
-/**
- * Prints the given attribute to the output buffer from C14N context.
- *
- * @param data1  		the pointer tls o first attr
- * @param data2  		the pointer to second attr
- * @returns -1 if attr1 < attr2, 0 if attr1 == attr2 or 1 if attr1 > attr2.
- */
-static int
-xmlC14NAttrsCompare(const void *data1, const void *data2)
-{
-    const xmlAttr *attr1 = data1;
-    const xmlAttr *attr2 = data2;
-    int ret = 0;
-
-    /*
-     * Simple cases
-     */
-    if (attr1 == attr2)
-        return (0);
-    if (attr1 == NULL)
-        return (-1);
-    if (attr2 == NULL)
-        return (1);
-    if (attr1->ns == attr2->ns) {
-        return (xmlStrcmp(attr1->name, attr2->name));
-    }
-
-    /*
-     * Attributes in the default namespace are first
-     * because the default namespace is not applied to
-     * unqualified attributes
-     */
-    if (attr1->ns == NULL)
-        return (-1);
-    if (attr2->ns == NULL)
-        return (1);
-    if (attr1->ns->prefix == NULL)
-        return (-1);
-    if (attr2->ns->prefix == NULL)
-        return (1);
-
-    ret = xmlStrcmp(attr1->ns->href, attr2->ns->href);
-    if (ret == 0) {
-        ret = xmlStrcmp(attr1->name, attr2->name);
-    }
-    return (ret);
-}
-
-
 /**
  * Prints out canonical attribute urrent node to the
  * buffer from C14N context as follows
@@ -1113,8 +1566,8 @@ static int
 xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
 {
     xmlAttrPtr attr;
-    xmlListPtr list;
     xmlAttrPtr attrs_to_delete = NULL;
+    int i;
 
     /* special processing for 1.1 spec */
     xmlAttrPtr xml_base_attr = NULL;
@@ -1127,13 +1580,9 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
     }
 
     /*
-     * Create a sorted list to store element attributes
+     * Collect the sort keys of element attributes
      */
-    list = xmlListCreate(NULL, xmlC14NAttrsCompare);
-    if (list == NULL) {
-        xmlC14NErrMemory(ctx);
-        return (-1);
-    }
+    ctx->sortNr = 0;
 
     switch(ctx->mode) {
     case XML_C14N_1_0:
@@ -1155,7 +1604,8 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
         while (attr != NULL) {
             /* check that attribute is visible */
             if (xmlC14NIsVisible(ctx, attr, cur)) {
-                xmlListInsert(list, attr);
+                if (xmlC14NSortAddAttr(ctx, attr) < 0)
+                    goto error;
             }
             attr = attr->next;
         }
@@ -1177,9 +1627,9 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
                 attr = tmp->properties;
                 while (attr != NULL) {
                     if (xmlC14NIsXmlAttr(attr) != 0) {
-                        if (xmlListSearch(list, attr) == NULL) {
-                            xmlListInsert(list, attr);
-                        }
+                        if ((!xmlC14NSortHasAttr(ctx, attr)) &&
+                            (xmlC14NSortAddAttr(ctx, attr) < 0))
+                            goto error;
                     }
                     attr = attr->next;
                 }
@@ -1201,7 +1651,8 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
         while (attr != NULL) {
             /* check that attribute is visible */
             if (xmlC14NIsVisible(ctx, attr, cur)) {
-                xmlListInsert(list, attr);
+                if (xmlC14NSortAddAttr(ctx, attr) < 0)
+                    goto error;
             }
             attr = attr->next;
         }
@@ -1246,7 +1697,8 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
             if ((!parent_visible) || (xmlC14NIsXmlAttr(attr) == 0)) {
                 /* check that attribute is visible */
                 if (xmlC14NIsVisible(ctx, attr, cur)) {
-                    xmlListInsert(list, attr);
+                    if (xmlC14NSortAddAttr(ctx, attr) < 0)
+                    goto error;
                 }
             } else {
                 int matched = 0;
@@ -1269,7 +1721,8 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
 
                 /* otherwise, it is a normal attribute, so just check if it is visible */
                 if((!matched) && xmlC14NIsVisible(ctx, attr, cur)) {
-                    xmlListInsert(list, attr);
+                    if (xmlC14NSortAddAttr(ctx, attr) < 0)
+                    goto error;
                 }
             }
 
@@ -1285,13 +1738,15 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
                 xml_lang_attr = xmlC14NFindHiddenParentAttr(ctx, cur->parent, BAD_CAST "lang", XML_XML_NAMESPACE);
             }
             if(xml_lang_attr != NULL) {
-                xmlListInsert(list, xml_lang_attr);
+                if (xmlC14NSortAddAttr(ctx, xml_lang_attr) < 0)
+                    goto error;
             }
             if(xml_space_attr == NULL) {
                 xml_space_attr = xmlC14NFindHiddenParentAttr(ctx, cur->parent, BAD_CAST "space", XML_XML_NAMESPACE);
             }
             if(xml_space_attr != NULL) {
-                xmlListInsert(list, xml_space_attr);
+                if (xmlC14NSortAddAttr(ctx, xml_space_attr) < 0)
+                    goto error;
             }
 
             /* base uri attribute - fix up */
@@ -1302,11 +1757,12 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
             if(xml_base_attr != NULL) {
                 xml_base_attr = xmlC14NFixupBaseAttr(ctx, xml_base_attr);
                 if(xml_base_attr != NULL) {
-                    xmlListInsert(list, xml_base_attr);
-
                     /* note that we MUST delete returned attr node ourselves! */
                     xml_base_attr->next = attrs_to_delete;
                     attrs_to_delete = xml_base_attr;
+
+                    if (xmlC14NSortAddAttr(ctx, xml_base_attr) < 0)
+                        goto error;
                 }
             }
         }
@@ -1316,16 +1772,24 @@ xmlC14NProcessAttrsAxis(xmlC14NCtxPtr ctx, xmlNodePtr cur, int parent_visible)
     }
 
     /*
-     * print out all elements from list
+     * print out all attributes in canonical order
      */
-    xmlListWalk(list, xmlC14NPrintAttrs, (void *) ctx);
+    xmlC14NSortKeys(ctx, xmlC14NAttrsCompare, xmlC14NAttrsQsortCompare);
+    for (i = 0; i < ctx->sortNr; i++) {
+        if (!xmlC14NPrintAttrs(ctx->sortTab[i].item, ctx))
+            break;
+    }
 
     /*
      * Cleanup
      */
     xmlFreePropList(attrs_to_delete);
-    xmlListDelete(list);
     return (0);
+
+error:
+    xmlC14NErrMemory(ctx);
+    xmlFreePropList(attrs_to_delete);
+    return (-1);
 }
 
 /**
@@ -1373,32 +1837,25 @@ xmlC14NCheckForRelativeNamespaces(xmlC14NCtxPtr ctx, xmlNodePtr cur)
 }
 
 /**
- * Canonical XML v 1.0 (http://www.w3.org/TR/xml-c14n)
- *
- * Element Nodes
- * If the element is not in the node-set, then the result is obtained
- * by processing the namespace axis, then the attribute axis, then
- * processing the child nodes of the element that are in the node-set
- * (in document order). If the element is in the node-set, then the result
- * is an open angle bracket (<), the element QName, the result of
- * processing the namespace axis, the result of processing the attribute
- * axis, a close angle bracket (>), the result of processing the child
- * nodes of the element that are in the node-set (in document order), an
- * open angle bracket, a forward slash (/), the element QName, and a close
- * angle bracket.
+ * Processes the start of an element: the open angle bracket, the
+ * element QName, the namespace and attribute axes and the close angle
+ * bracket. The position of the visible namespace stack is saved in
+ * `state` for #xmlC14NEndElement.
  *
  * @param ctx  		the pointer to C14N context object
  * @param cur  		the node to process
  * @param visible  		this node is visible
+ * @param state  		where to save the visible namespace stack
+ * @param parent_is_doc  	set if this is the document element
  * @returns non-negative value on success or negative value on fail
  */
 static int
-xmlC14NProcessElementNode(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
+xmlC14NStartElement(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible,
+                    xmlC14NVisibleNsStackPtr state, int *parent_is_doc)
 {
     int ret;
-    xmlC14NVisibleNsStack state;
-    int parent_is_doc = 0;
 
+    *parent_is_doc = 0;
     if ((ctx == NULL) || (cur == NULL) || (cur->type != XML_ELEMENT_NODE)) {
         xmlC14NErrParam(ctx);
         return (-1);
@@ -1415,13 +1872,13 @@ xmlC14NProcessElementNode(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
     /*
      * Save ns_rendered stack position
      */
-    memset(&state, 0, sizeof(state));
-    xmlC14NVisibleNsStackSave(ctx->ns_rendered, &state);
+    memset(state, 0, sizeof(*state));
+    xmlC14NVisibleNsStackSave(ctx->ns_rendered, state);
 
     if (visible) {
         if (ctx->parent_is_doc) {
 	    /* save this flag into the stack */
-	    parent_is_doc = ctx->parent_is_doc;
+	    *parent_is_doc = ctx->parent_is_doc;
 	    ctx->parent_is_doc = 0;
             ctx->pos = XMLC14N_INSIDE_DOCUMENT_ELEMENT;
         }
@@ -1454,11 +1911,23 @@ xmlC14NProcessElementNode(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
     if (visible) {
         xmlOutputBufferWriteString(ctx->buf, ">");
     }
-    if (cur->children != NULL) {
-        ret = xmlC14NProcessNodeList(ctx, cur->children);
-        if (ret < 0)
-            return (-1);
-    }
+    return (0);
+}
+
+/**
+ * Processes the end of an element started with #xmlC14NStartElement:
+ * the end tag and the restore of the visible namespace stack.
+ *
+ * @param ctx  		the pointer to C14N context object
+ * @param cur  		the node to process
+ * @param visible  		this node is visible
+ * @param state  		the state saved by #xmlC14NStartElement
+ * @param parent_is_doc  	the flag set by #xmlC14NStartElement
+ */
+static void
+xmlC14NEndElement(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible,
+                  xmlC14NVisibleNsStackPtr state, int parent_is_doc)
+{
     if (visible) {
         xmlOutputBufferWriteString(ctx->buf, "</");
         if ((cur->ns != NULL) && (xmlStrlen(cur->ns->prefix) > 0)) {
@@ -1478,7 +1947,45 @@ xmlC14NProcessElementNode(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
     /*
      * Restore ns_rendered stack position
      */
-    xmlC14NVisibleNsStackRestore(ctx->ns_rendered, &state);
+    xmlC14NVisibleNsStackRestore(ctx->ns_rendered, state);
+}
+
+/**
+ * Canonical XML v 1.0 (http://www.w3.org/TR/xml-c14n)
+ *
+ * Element Nodes
+ * If the element is not in the node-set, then the result is obtained
+ * by processing the namespace axis, then the attribute axis, then
+ * processing the child nodes of the element that are in the node-set
+ * (in document order). If the element is in the node-set, then the result
+ * is an open angle bracket (<), the element QName, the result of
+ * processing the namespace axis, the result of processing the attribute
+ * axis, a close angle bracket (>), the result of processing the child
+ * nodes of the element that are in the node-set (in document order), an
+ * open angle bracket, a forward slash (/), the element QName, and a close
+ * angle bracket.
+ *
+ * @param ctx  		the pointer to C14N context object
+ * @param cur  		the node to process
+ * @param visible  		this node is visible
+ * @returns non-negative value on success or negative value on fail
+ */
+static int
+xmlC14NProcessElementNode(xmlC14NCtxPtr ctx, xmlNodePtr cur, int visible)
+{
+    int ret;
+    xmlC14NVisibleNsStack state;
+    int parent_is_doc = 0;
+
+    ret = xmlC14NStartElement(ctx, cur, visible, &state, &parent_is_doc);
+    if (ret < 0)
+        return (-1);
+    if (cur->children != NULL) {
+        ret = xmlC14NProcessNodeList(ctx, cur->children);
+        if (ret < 0)
+            return (-1);
+    }
+    xmlC14NEndElement(ctx, cur, visible, &state, parent_is_doc);
     return (0);
 }
 
@@ -1709,6 +2216,7 @@ xmlC14NFreeCtx(xmlC14NCtxPtr ctx)
     if (ctx->ns_rendered != NULL) {
         xmlC14NVisibleNsStackDestroy(ctx->ns_rendered);
     }
+    xmlFree(ctx->sortTab);
     xmlFree(ctx);
 }
 
@@ -1773,6 +2281,7 @@ xmlC14NNewCtx(xmlDocPtr doc,
     ctx->buf = buf;
     ctx->parent_is_doc = 1;
     ctx->pos = XMLC14N_BEFORE_DOCUMENT_ELEMENT;
+    xmlNsIdCacheInit(&ctx->nsIds, doc->dict);
     ctx->ns_rendered = xmlC14NVisibleNsStackCreate();
 
     if(ctx->ns_rendered == NULL) {
@@ -1917,13 +2426,35 @@ int
 xmlC14NDocSaveTo(xmlDoc *doc, xmlNodeSet *nodes,
                  int mode, xmlChar ** inclusive_ns_prefixes,
                  int with_comments, xmlOutputBuffer *buf) {
-    return(xmlC14NExecute(doc,
+    xmlC14NNodeSetIndex idx;
+    int ret;
+
+    if ((nodes == NULL) || (nodes->nodeNr < XML_C14N_INDEX_MIN))
+        return(xmlC14NExecute(doc,
 			xmlC14NIsNodeInNodeset,
 			nodes,
 			mode,
 			inclusive_ns_prefixes,
 			with_comments,
 			buf));
+
+    /*
+     * Visibility is checked for every node of the document, index
+     * the node-set once.
+     */
+    if (xmlC14NNodeSetIndexBuild(&idx, nodes) < 0) {
+        xmlC14NErrMemory(NULL);
+        return(-1);
+    }
+    ret = xmlC14NExecute(doc,
+			xmlC14NIsNodeInNodeSetIndex,
+			&idx,
+			mode,
+			inclusive_ns_prefixes,
+			with_comments,
+			buf);
+    xmlFree(idx.tab);
+    return(ret);
 }
 
 
@@ -2057,6 +2588,431 @@ xmlC14NDocSave(xmlDoc *doc, xmlNodeSet *nodes,
     return (ret);
 }
 
+static int
+xmlC14NDigestWrite(void *context, const char *buffer, int len) {
+    xmlC14NReference *ref = (xmlC14NReference *) context;
+
+    if (ref->digest(ref->ctxt, (const unsigned char *) buffer, len) < 0)
+        return(-1);
+    return(len);
+}
+
+/**
+ * Canonicalizes several references of a document in a single pass over
+ * the tree and passes the canonical form of each reference to its
+ * digest callback. No copy of the canonical documents is made, the
+ * output is handed to the callbacks in chunks of a few kilobytes.
+ *
+ * Each reference has its own node set, mode, inclusive namespace
+ * prefixes and comment setting, see #xmlC14NDocSaveTo.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  		the XML document for canonization
+ * @param refs  		the references
+ * @param nbRefs  		the number of references
+ * @returns 0 on success or a negative value on fail
+ */
+int
+xmlC14NDigestReferences(xmlDoc *doc, xmlC14NReference *refs, int nbRefs) {
+    xmlC14NCtxPtr *ctxs = NULL;
+    xmlC14NNodeSetIndex *idxs = NULL;
+    xmlC14NElemFrame *frames = NULL;
+    int maxDepth = 0;
+    int depth = 0;
+    xmlNodePtr cur;
+    int ret = -1;
+    int i;
+
+    if ((doc == NULL) || (refs == NULL) || (nbRefs <= 0)) {
+        xmlC14NErrParam(NULL);
+        return(-1);
+    }
+    for (i = 0; i < nbRefs; i++) {
+        if ((refs[i].digest == NULL) ||
+            ((refs[i].mode != XML_C14N_1_0) &&
+             (refs[i].mode != XML_C14N_EXCLUSIVE_1_0) &&
+             (refs[i].mode != XML_C14N_1_1))) {
+            xmlC14NErrParam(NULL);
+            return(-1);
+        }
+    }
+
+    ctxs = xmlMalloc(nbRefs * sizeof(ctxs[0]));
+    idxs = xmlMalloc(nbRefs * sizeof(idxs[0]));
+    if ((ctxs == NULL) || (idxs == NULL)) {
+        xmlC14NErrMemory(NULL);
+        goto done;
+    }
+    memset(ctxs, 0, nbRefs * sizeof(ctxs[0]));
+    memset(idxs, 0, nbRefs * sizeof(idxs[0]));
+
+    for (i = 0; i < nbRefs; i++) {
+        xmlNodeSetPtr nodes = refs[i].nodes;
+        xmlC14NIsVisibleCallback visible = NULL;
+        void *user_data = NULL;
+        xmlOutputBufferPtr buf;
+
+        if ((nodes != NULL) && (nodes->nodeNr >= XML_C14N_INDEX_MIN)) {
+            if (xmlC14NNodeSetIndexBuild(&idxs[i], nodes) < 0) {
+                xmlC14NErrMemory(NULL);
+                goto done;
+            }
+            visible = xmlC14NIsNodeInNodeSetIndex;
+            user_data = &idxs[i];
+        } else if (nodes != NULL) {
+            visible = xmlC14NIsNodeInNodeset;
+            user_data = nodes;
+        }
+
+        buf = xmlOutputBufferCreateIO(xmlC14NDigestWrite, NULL, &refs[i],
+                                      NULL);
+        if (buf == NULL) {
+            xmlC14NErrMemory(NULL);
+            goto done;
+        }
+        ctxs[i] = xmlC14NNewCtx(doc, visible, user_data,
+                                (xmlC14NMode) refs[i].mode,
+                                refs[i].inclusive_ns_prefixes,
+                                refs[i].with_comments, buf);
+        if (ctxs[i] == NULL) {
+            xmlOutputBufferClose(buf);
+            xmlC14NErr(NULL, (xmlNodePtr) doc, XML_C14N_CREATE_CTXT,
+                       "xmlC14NDigestReferences: unable to create C14N "
+                       "context\n");
+            goto done;
+        }
+    }
+
+    /*
+     * Walk the tree once, every node is processed for all references
+     * before moving to the next one. The open elements of all
+     * references are kept in frames, nbRefs per level.
+     */
+    cur = doc->children;
+    while (cur != NULL) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            xmlC14NElemFrame *frame;
+
+            if (depth >= maxDepth) {
+                xmlC14NElemFrame *tmp;
+                int newSize;
+
+                newSize = xmlGrowCapacity(maxDepth,
+                                          nbRefs * sizeof(tmp[0]),
+                                          10, XML_MAX_ITEMS);
+                if (newSize < 0) {
+                    xmlC14NErrMemory(NULL);
+                    goto done;
+                }
+                tmp = xmlRealloc(frames,
+                                 (size_t) newSize * nbRefs * sizeof(tmp[0]));
+                if (tmp == NULL) {
+                    xmlC14NErrMemory(NULL);
+                    goto done;
+                }
+                frames = tmp;
+                maxDepth = newSize;
+            }
+
+            frame = &frames[depth * nbRefs];
+            for (i = 0; i < nbRefs; i++) {
+                frame[i].visible = xmlC14NIsVisible(ctxs[i], cur, cur->parent);
+                if (xmlC14NStartElement(ctxs[i], cur, frame[i].visible,
+                                        &frame[i].state,
+                                        &frame[i].parent_is_doc) < 0)
+                    goto done;
+            }
+            if (cur->children != NULL) {
+                depth++;
+                cur = cur->children;
+                continue;
+            }
+            for (i = 0; i < nbRefs; i++)
+                xmlC14NEndElement(ctxs[i], cur, frame[i].visible,
+                                  &frame[i].state, frame[i].parent_is_doc);
+        } else {
+            for (i = 0; i < nbRefs; i++) {
+                if (xmlC14NProcessNode(ctxs[i], cur) < 0)
+                    goto done;
+            }
+        }
+
+        while ((cur->next == NULL) && (depth > 0)) {
+            xmlC14NElemFrame *frame;
+
+            cur = cur->parent;
+            depth--;
+            frame = &frames[depth * nbRefs];
+            for (i = 0; i < nbRefs; i++)
+                xmlC14NEndElement(ctxs[i], cur, frame[i].visible,
+                                  &frame[i].state, frame[i].parent_is_doc);
+        }
+        cur = cur->next;
+    }
+    ret = 0;
+
+done:
+    if (ctxs != NULL) {
+        for (i = 0; i < nbRefs; i++) {
+            if (ctxs[i] == NULL)
+                continue;
+            /* Flush the rest of the output to the callback */
+            if (xmlOutputBufferClose(ctxs[i]->buf) < 0)
+                ret = -1;
+            xmlC14NFreeCtx(ctxs[i]);
+        }
+        xmlFree(ctxs);
+    }
+    if (idxs != NULL) {
+        for (i = 0; i < nbRefs; i++)
+            xmlFree(idxs[i].tab);
+        xmlFree(idxs);
+    }
+    xmlFree(frames);
+    return(ret);
+}
+
+/**
+ * Canonicalizes a document and passes the canonical form to `digest`,
+ * typically to update a hash, without buffering the whole output. See
+ * #xmlC14NDocSaveTo for the other parameters and
+ * #xmlC14NDigestReferences to digest several references in one pass.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  		the XML document for canonization
+ * @param nodes  		the nodes set to be included in the canonized image
+ *		or NULL if all document nodes should be included
+ * @param mode  		the c14n mode (see `xmlC14NMode`)
+ * @param inclusive_ns_prefixes  the list of inclusive namespace prefixes
+ *			ended with a NULL or NULL if there is no
+ *			inclusive namespaces (only for exclusive
+ *			canonicalization, ignored otherwise)
+ * @param with_comments  	include comments in the result (!=0) or not (==0)
+ * @param digest  		the callback receiving the canonical output
+ * @param ctxt  		the first argument of `digest`
+ * @returns 0 on success or a negative value on fail
+ */
+int
+xmlC14NDocDigest(xmlDoc *doc, xmlNodeSet *nodes, int mode,
+                 xmlChar **inclusive_ns_prefixes, int with_comments,
+                 xmlC14NDigestCallback digest, void *ctxt) {
+    xmlC14NReference ref;
+
+    memset(&ref, 0, sizeof(ref));
+    ref.nodes = nodes;
+    ref.mode = mode;
+    ref.inclusive_ns_prefixes = inclusive_ns_prefixes;
+    ref.with_comments = with_comments;
+    ref.digest = digest;
+    ref.ctxt = ctxt;
+    return(xmlC14NDigestReferences(doc, &ref, 1));
+}
+
+#ifdef LIBXML_READER_ENABLED
+/*
+ * Visibility callback for a subtree canonicalized from a reader: only
+ * the element ancestors of the subtree root are omitted.
+ */
+static int
+xmlC14NIsInReaderSubtree(void *user_data, xmlNodePtr node,
+                         xmlNodePtr parent ATTRIBUTE_UNUSED) {
+    xmlNodePtr root = (xmlNodePtr) user_data;
+    xmlNodePtr tmp;
+
+    if ((node == NULL) || (node->type != XML_ELEMENT_NODE))
+        return(1);
+    for (tmp = root->parent; tmp != NULL; tmp = tmp->parent) {
+        if (tmp == node)
+            return(0);
+    }
+    return(1);
+}
+
+/**
+ * Canonicalizes the document read by `reader` without building the
+ * whole tree. The reader only keeps the ancestors of the current node,
+ * so memory use is bounded by the depth of the document, not its size.
+ *
+ * If the reader is positioned on an element, only the subtree of this
+ * element is canonicalized, as if the document subset were the element
+ * and its descendants, and the reader is left on the end of the element.
+ * Otherwise the reader must not have been read yet and the whole
+ * document is canonicalized.
+ *
+ * Like for the tree based functions, the reader should be created with
+ * XML_PARSE_NOENT and XML_PARSE_DTDATTR. Entity references are
+ * reported as errors. Not available in flat mode.
+ *
+ * For details see "Canonical XML" (http://www.w3.org/TR/xml-c14n) or
+ * "Exclusive XML Canonicalization" (http://www.w3.org/TR/xml-exc-c14n)
+ *
+ * @since 2.16.0
+ *
+ * @param reader  		the reader
+ * @param mode  		the c14n mode (see `xmlC14NMode`)
+ * @param inclusive_ns_prefixes  the list of inclusive namespace prefixes
+ *			ended with a NULL or NULL if there is no
+ *			inclusive namespaces (only for exclusive
+ *			canonicalization, ignored otherwise)
+ * @param with_comments  	include comments in the result (!=0) or not (==0)
+ * @param buf  		the output buffer to store canonical XML; this
+ *			buffer MUST have encoder==NULL because C14N requires
+ *			UTF-8 output
+ * @returns non-negative value on success or a negative value on fail
+ */
+int
+xmlC14NReaderSaveTo(xmlTextReader *reader, int mode,
+                    xmlChar **inclusive_ns_prefixes, int with_comments,
+                    xmlOutputBuffer *buf) {
+    xmlC14NCtxPtr ctx;
+    xmlC14NMode c14n_mode = XML_C14N_1_0;
+    xmlC14NElemFrame *frames = NULL;
+    int nbFrames = 0;
+    int maxFrames = 0;
+    xmlNodePtr node, root = NULL;
+    int ret;
+
+    if ((reader == NULL) || (buf == NULL)) {
+        xmlC14NErrParam(NULL);
+        return (-1);
+    }
+
+    switch(mode) {
+    case XML_C14N_1_0:
+    case XML_C14N_EXCLUSIVE_1_0:
+    case XML_C14N_1_1:
+         c14n_mode = (xmlC14NMode)mode;
+         break;
+    default:
+        xmlC14NErrParam(NULL);
+        return (-1);
+    }
+
+    if (buf->encoder != NULL) {
+        xmlC14NErr(NULL, NULL, XML_C14N_REQUIRES_UTF8,
+"xmlC14NReaderSaveTo: output buffer encoder != NULL but C14N requires UTF8 output\n");
+        return (-1);
+    }
+
+    if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) {
+        root = xmlTextReaderCurrentNode(reader);
+        ret = 1;
+    } else if (xmlTextReaderReadState(reader) ==
+               XML_TEXTREADER_MODE_INITIAL) {
+        ret = xmlTextReaderRead(reader);
+    } else {
+        xmlC14NErrParam(NULL);
+        return (-1);
+    }
+    if (ret <= 0)
+        return (-1);
+    node = xmlTextReaderCurrentNode(reader);
+    if (node == NULL) {
+        xmlC14NErrParam(NULL);
+        return (-1);
+    }
+
+    ctx = xmlC14NNewCtx(node->doc,
+                        (root != NULL) ? xmlC14NIsInReaderSubtree : NULL,
+                        root, c14n_mode, inclusive_ns_prefixes,
+                        with_comments, buf);
+    if (ctx == NULL) {
+        xmlC14NErr(NULL, NULL, XML_C14N_CREATE_CTXT,
+		   "xmlC14NReaderSaveTo: unable to create C14N context\n");
+        return (-1);
+    }
+
+    /*
+     * Elements are split into start and end events, the stack of
+     * open elements replaces the recursion of xmlC14NProcessNode.
+     */
+    while (ret == 1) {
+        int type = xmlTextReaderNodeType(reader);
+
+        node = xmlTextReaderCurrentNode(reader);
+        if (node == NULL) {
+            xmlC14NErrParam(ctx);
+            ret = -1;
+            break;
+        }
+
+        if (type == XML_READER_TYPE_ELEMENT) {
+            xmlC14NElemFrame *frame;
+
+            if (nbFrames >= maxFrames) {
+                xmlC14NElemFrame *tmp;
+                int newSize;
+
+                newSize = xmlGrowCapacity(maxFrames, sizeof(tmp[0]),
+                                          10, XML_MAX_ITEMS);
+                if (newSize < 0) {
+                    xmlC14NErrMemory(ctx);
+                    ret = -1;
+                    break;
+                }
+                tmp = xmlRealloc(frames, newSize * sizeof(tmp[0]));
+                if (tmp == NULL) {
+                    xmlC14NErrMemory(ctx);
+                    ret = -1;
+                    break;
+                }
+                frames = tmp;
+                maxFrames = newSize;
+            }
+            frame = &frames[nbFrames];
+
+            frame->visible = 1;
+            ret = xmlC14NStartElement(ctx, node, 1, &frame->state,
+                                      &frame->parent_is_doc);
+            if (ret < 0)
+                break;
+            if (xmlTextReaderIsEmptyElement(reader))
+                xmlC14NEndElement(ctx, node, 1, &frame->state,
+                                  frame->parent_is_doc);
+            else
+                nbFrames++;
+        } else if (type == XML_READER_TYPE_END_ELEMENT) {
+            if (nbFrames <= 0) {
+                xmlC14NErrParam(ctx);
+                ret = -1;
+                break;
+            }
+            nbFrames--;
+            xmlC14NEndElement(ctx, node, 1, &frames[nbFrames].state,
+                              frames[nbFrames].parent_is_doc);
+        } else {
+            ret = xmlC14NProcessNode(ctx, node);
+            if (ret < 0)
+                break;
+        }
+
+        if ((root != NULL) && (nbFrames == 0))
+            break;
+        ret = xmlTextReaderRead(reader);
+    }
+    xmlFree(frames);
+    if (ret < 0) {
+        xmlC14NFreeCtx(ctx);
+        return (-1);
+    }
+
+    /*
+     * Flush buffer to get number of bytes written
+     */
+    ret = xmlOutputBufferFlush(buf);
+    if (ret < 0) {
+        xmlC14NErr(ctx, NULL, buf->error, "flushing output buffer");
+        xmlC14NFreeCtx(ctx);
+        return (-1);
+    }
+
+    xmlC14NFreeCtx(ctx);
+    return (ret);
+}
+#endif /* LIBXML_READER_ENABLED */
+
 /**
  * Converts a string to a canonical (normalized) format. The code is stolen
  * from xmlEscapeText. Added normalization of `\x09`, `\x0a`,
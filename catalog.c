@@ -105,6 +105,9 @@ typedef enum {
 #endif
 } xmlCatalogEntryType;
 
+typedef struct _xmlCatalogIndex xmlCatalogIndex;
+typedef xmlCatalogIndex *xmlCatalogIndexPtr;
+
 typedef struct _xmlCatalogEntry xmlCatalogEntry;
 typedef xmlCatalogEntry *xmlCatalogEntryPtr;
 struct _xmlCatalogEntry {
@@ -119,6 +122,44 @@ struct _xmlCatalogEntry {
     int dealloc;
     int depth;
     struct _xmlCatalogEntry *group;
+    xmlCatalogIndexPtr index;	/* lookup index, only on list heads */
+};
+
+/*
+ * Entries of a list of catalog entries whose name is a prefix
+ * matched against identifiers.
+ */
+typedef struct _xmlCatalogPrefix xmlCatalogPrefix;
+struct _xmlCatalogPrefix {
+    xmlCatalogPrefix *next;	/* next entry with the same name */
+    xmlCatalogEntryPtr entry;
+    int pos;			/* position in the entry list */
+};
+
+typedef struct {
+    xmlHashTablePtr hash;	/* name -> first xmlCatalogPrefix */
+    int *lengths;		/* distinct name lengths, decreasing */
+    int nbLengths;
+} xmlCatalogPrefixTable;
+
+/*
+ * Index of a list of catalog entries, built on first lookup so that
+ * resolution doesn't have to scan every entry of large catalogs.
+ */
+struct _xmlCatalogIndex {
+    int refs;			/* lookups in progress */
+    int stale;			/* list was modified, free when unused */
+    xmlHashTablePtr system;	/* exact matches, first entry wins */
+    xmlHashTablePtr pub;
+    xmlHashTablePtr uri;
+    xmlCatalogPrefixTable rewriteSystem;
+    xmlCatalogPrefixTable rewriteURI;
+    xmlCatalogPrefixTable delegateSystem;
+    xmlCatalogPrefixTable delegatePublic;
+    xmlCatalogPrefixTable delegateURI; /* includes delegateSystem */
+    xmlCatalogPrefix *prefixes;
+    xmlCatalogEntryPtr *nextCatalogs;
+    int nbNextCatalogs;
 };
 
 typedef enum {
@@ -152,6 +193,13 @@ struct _xmlCatalog {
      */
     xmlCatalogPrefer prefer;
     xmlCatalogEntryPtr xml;
+
+    /*
+     * Memoized results of XML catalog lookups, protected by
+     * xmlCatalogMemoMutex
+     */
+    xmlHashTablePtr memo;
+    unsigned memoGeneration;
 };
 
 /************************************************************************
@@ -191,6 +239,17 @@ static xmlRMutex xmlCatalogMutex;
  */
 static int xmlCatalogInitialized = 0;
 
+/*
+ * Protects the memo tables of all catalogs and the generation
+ * counter which is incremented whenever a catalog is modified.
+ */
+static xmlMutex xmlCatalogMemoMutex;
+static unsigned xmlCatalogGeneration;
+static int xmlCatalogMemoMax = 0;
+
+/* Memoized result of a lookup which found nothing */
+static const xmlChar xmlCatalogMemoNone[] = "";
+
 /************************************************************************
  *									*
  *			Catalog error handlers				*
@@ -301,11 +360,14 @@ xmlNewCatalogEntry(xmlCatalogEntryType type, const xmlChar *name,
     ret->dealloc = 0;
     ret->depth = 0;
     ret->group = group;
+    ret->index = NULL;
     return(ret);
 }
 
 static void
 xmlFreeCatalogEntryList(xmlCatalogEntryPtr ret);
+static void
+xmlCatalogFreeIndex(xmlCatalogIndexPtr idx);
 
 /**
  * Free the memory allocated to a Catalog entry
@@ -343,6 +405,8 @@ xmlFreeCatalogEntry(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
 	xmlFree(ret->value);
     if (ret->URL != NULL)
 	xmlFree(ret->URL);
+    if (ret->index != NULL)
+        xmlCatalogFreeIndex(ret->index);
     xmlFree(ret);
 }
 
@@ -419,6 +483,111 @@ xmlCreateNewCatalog(xmlCatalogType type, xmlCatalogPrefer prefer) {
     return(ret);
 }
 
+static void
+xmlCatalogFreeMemo(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    if (payload != xmlCatalogMemoNone)
+        xmlFree(payload);
+}
+
+/**
+ * Invalidate the memoized lookups of all catalogs. Must be called
+ * after any change which can affect the result of a lookup.
+ */
+static void
+xmlCatalogInvalidateMemo(void) {
+    xmlInitParser();
+
+    xmlMutexLock(&xmlCatalogMemoMutex);
+    xmlCatalogGeneration++;
+    xmlMutexUnlock(&xmlCatalogMemoMutex);
+}
+
+/**
+ * Look up a memoized result.
+ *
+ * Resolving through a large set of XML catalogs walks long entry
+ * lists and normalizes identifiers for every lookup, while the
+ * same few identifiers are resolved again and again.
+ *
+ * @param catal  the catalog
+ * @param kind  the type of lookup
+ * @param pubID  the public ID (optional)
+ * @param sysID  the system ID or URI (optional)
+ * @param result  set to a copy of the result, possibly NULL
+ * @returns 1 if found, 0 otherwise.
+ */
+static int
+xmlCatalogMemoLookup(xmlCatalogPtr catal, const char *kind,
+                     const xmlChar *pubID, const xmlChar *sysID,
+                     xmlChar **result) {
+    const xmlChar *memo = NULL;
+    int ret = 0;
+
+    if ((catal->type != XML_XML_CATALOG_TYPE) || (xmlDebugCatalogs))
+        return(0);
+
+    xmlInitParser();
+
+    xmlMutexLock(&xmlCatalogMemoMutex);
+    if ((catal->memo != NULL) && (xmlCatalogMemoMax > 0) &&
+        (catal->memoGeneration == xmlCatalogGeneration))
+        memo = xmlHashLookup3(catal->memo, BAD_CAST kind, pubID, sysID);
+    if (memo == xmlCatalogMemoNone) {
+        *result = NULL;
+        ret = 1;
+    } else if (memo != NULL) {
+        *result = xmlStrdup(memo);
+        ret = (*result != NULL);
+    }
+    xmlMutexUnlock(&xmlCatalogMemoMutex);
+
+    return(ret);
+}
+
+/**
+ * Memoize the result of a lookup.
+ *
+ * @param catal  the catalog
+ * @param kind  the type of lookup
+ * @param pubID  the public ID (optional)
+ * @param sysID  the system ID or URI (optional)
+ * @param result  the result or NULL
+ */
+static void
+xmlCatalogMemoStore(xmlCatalogPtr catal, const char *kind,
+                    const xmlChar *pubID, const xmlChar *sysID,
+                    const xmlChar *result) {
+    xmlChar *copy = (xmlChar *) xmlCatalogMemoNone;
+
+    if ((catal->type != XML_XML_CATALOG_TYPE) || (xmlDebugCatalogs))
+        return;
+
+    if (result != NULL) {
+        copy = xmlStrdup(result);
+        if (copy == NULL)
+            return;
+    }
+
+    xmlMutexLock(&xmlCatalogMemoMutex);
+    /* Start over if the catalogs changed or the table is full */
+    if ((catal->memo != NULL) &&
+        ((catal->memoGeneration != xmlCatalogGeneration) ||
+         (xmlHashSize(catal->memo) >= xmlCatalogMemoMax))) {
+        xmlHashFree(catal->memo, xmlCatalogFreeMemo);
+        catal->memo = NULL;
+    }
+    if ((catal->memo == NULL) && (xmlCatalogMemoMax > 0)) {
+        catal->memo = xmlHashCreate(0);
+        catal->memoGeneration = xmlCatalogGeneration;
+    }
+    if ((catal->memo != NULL) &&
+        (xmlHashAdd3(catal->memo, BAD_CAST kind, pubID, sysID, copy) > 0))
+        copy = NULL;
+    xmlMutexUnlock(&xmlCatalogMemoMutex);
+
+    xmlCatalogFreeMemo(copy, NULL);
+}
+
 /**
  * Free the memory allocated to a Catalog
  *
@@ -436,6 +605,7 @@ xmlFreeCatalog(xmlCatalog *catal) {
     if (catal->sgml != NULL)
 	xmlHashFree(catal->sgml, xmlFreeCatalogEntry);
 #endif
+    xmlHashFree(catal->memo, xmlCatalogFreeMemo);
     xmlFree(catal);
 }
 
@@ -788,6 +958,7 @@ xmlConvertSGMLCatalog(xmlCatalog *catal) {
 	xmlCatalogPrintDebug(
 		"Converting SGML catalog to XML\n");
     }
+    xmlCatalogInvalidateMemo();
     xmlHashScan(catal->sgml, xmlCatalogConvertEntry, &catal);
     return(0);
 }
@@ -1037,7 +1208,8 @@ static xmlCatalogEntryPtr
 xmlParseXMLCatalogFile(xmlCatalogPrefer prefer, const xmlChar *filename);
 static void
 xmlParseXMLCatalogNodeList(xmlNodePtr cur, xmlCatalogPrefer prefer,
-	                   xmlCatalogEntryPtr parent, xmlCatalogEntryPtr cgroup);
+	                   xmlCatalogEntryPtr parent, xmlCatalogEntryPtr cgroup,
+	                   xmlCatalogEntryPtr *last);
 static xmlChar *
 xmlCatalogListXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
 	              const xmlChar *sysID);
@@ -1160,10 +1332,12 @@ xmlParseXMLCatalogOneNode(xmlNodePtr cur, xmlCatalogEntryType type,
  * @param prefer  the PUBLIC vs. SYSTEM current preference value
  * @param parent  the parent Catalog entry
  * @param cgroup  the group which includes this node
+ * @param last  the last child of parent, updated
  */
 static void
 xmlParseXMLCatalogNode(xmlNodePtr cur, xmlCatalogPrefer prefer,
-	               xmlCatalogEntryPtr parent, xmlCatalogEntryPtr cgroup)
+	               xmlCatalogEntryPtr parent, xmlCatalogEntryPtr cgroup,
+	               xmlCatalogEntryPtr *last)
 {
     xmlChar *base = NULL;
     xmlCatalogEntryPtr entry = NULL;
@@ -1230,23 +1404,19 @@ xmlParseXMLCatalogNode(xmlNodePtr cur, xmlCatalogPrefer prefer,
     if (entry != NULL) {
         if (parent != NULL) {
 	    entry->parent = parent;
-	    if (parent->children == NULL)
+	    if (*last == NULL)
 		parent->children = entry;
-	    else {
-		xmlCatalogEntryPtr prev;
-
-		prev = parent->children;
-		while (prev->next != NULL)
-		    prev = prev->next;
-		prev->next = entry;
-	    }
+	    else
+		(*last)->next = entry;
+	    *last = entry;
 	}
 	if (entry->type == XML_CATA_GROUP) {
 	    /*
 	     * Recurse to propagate prefer to the subtree
 	     * (xml:base handling is automated)
 	     */
-            xmlParseXMLCatalogNodeList(cur->children, prefer, parent, entry);
+            xmlParseXMLCatalogNodeList(cur->children, prefer, parent, entry,
+                                       last);
 	}
     }
     if (base != NULL)
@@ -1262,14 +1432,16 @@ xmlParseXMLCatalogNode(xmlNodePtr cur, xmlCatalogPrefer prefer,
  * @param prefer  the PUBLIC vs. SYSTEM current preference value
  * @param parent  the parent Catalog entry
  * @param cgroup  the group which includes this list
+ * @param last  the last child of parent, updated
  */
 static void
 xmlParseXMLCatalogNodeList(xmlNodePtr cur, xmlCatalogPrefer prefer,
-	                   xmlCatalogEntryPtr parent, xmlCatalogEntryPtr cgroup) {
+	                   xmlCatalogEntryPtr parent, xmlCatalogEntryPtr cgroup,
+	                   xmlCatalogEntryPtr *last) {
     while (cur != NULL) {
 	if ((cur->ns != NULL) && (cur->ns->href != NULL) &&
 	    (xmlStrEqual(cur->ns->href, XML_CATALOGS_NAMESPACE))) {
-	    xmlParseXMLCatalogNode(cur, prefer, parent, cgroup);
+	    xmlParseXMLCatalogNode(cur, prefer, parent, cgroup, last);
 	}
 	cur = cur->next;
     }
@@ -1290,6 +1462,7 @@ xmlParseXMLCatalogFile(xmlCatalogPrefer prefer, const xmlChar *filename) {
     xmlNodePtr cur;
     xmlChar *prop;
     xmlCatalogEntryPtr parent = NULL;
+    xmlCatalogEntryPtr last = NULL;
 
     if (filename == NULL)
         return(NULL);
@@ -1332,7 +1505,7 @@ xmlParseXMLCatalogFile(xmlCatalogPrefer prefer, const xmlChar *filename) {
 	    xmlFree(prop);
 	}
 	cur = cur->children;
-	xmlParseXMLCatalogNodeList(cur, prefer, parent, NULL);
+	xmlParseXMLCatalogNodeList(cur, prefer, parent, NULL, &last);
     } else {
 	xmlCatalogErr(NULL, (xmlNodePtr) doc, XML_CATALOG_NOT_CATALOG,
 		      "File %s is not an XML Catalog\n",
@@ -1421,6 +1594,383 @@ xmlFetchXMLCatalogFile(xmlCatalogEntryPtr catal) {
     return(0);
 }
 
+/************************************************************************
+ *									*
+ *			Catalog entry index				*
+ *									*
+ ************************************************************************/
+
+static void
+xmlCatalogFreeIndex(xmlCatalogIndexPtr idx) {
+    xmlCatalogPrefixTable *tables[5];
+    int i;
+
+    tables[0] = &idx->rewriteSystem;
+    tables[1] = &idx->rewriteURI;
+    tables[2] = &idx->delegateSystem;
+    tables[3] = &idx->delegatePublic;
+    tables[4] = &idx->delegateURI;
+    for (i = 0; i < 5; i++) {
+        xmlHashFree(tables[i]->hash, NULL);
+        xmlFree(tables[i]->lengths);
+    }
+    xmlHashFree(idx->system, NULL);
+    xmlHashFree(idx->pub, NULL);
+    xmlHashFree(idx->uri, NULL);
+    xmlFree(idx->prefixes);
+    xmlFree(idx->nextCatalogs);
+    xmlFree(idx);
+}
+
+static int
+xmlCatalogCompareLengths(const void *a, const void *b) {
+    return(*(const int *) b - *(const int *) a);
+}
+
+/**
+ * Add an entry to a prefix table. Entries must be added in list
+ * order. The lengths array must be large enough for all entries.
+ *
+ * @param table  the prefix table
+ * @param item  the entry to add
+ * @returns 0 on success, -1 on error
+ */
+static int
+xmlCatalogPrefixAdd(xmlCatalogPrefixTable *table, xmlCatalogPrefix *item) {
+    const xmlChar *key = item->entry->name;
+    xmlCatalogPrefix *head;
+
+    if (key == NULL)
+        key = BAD_CAST "";
+    if (table->hash == NULL) {
+        table->hash = xmlHashCreate(0);
+        if (table->hash == NULL)
+            return(-1);
+    }
+    head = xmlHashLookup(table->hash, key);
+    if (head == NULL) {
+        if (xmlHashAdd(table->hash, key, item) <= 0)
+            return(-1);
+        table->lengths[table->nbLengths++] = xmlStrlen(key);
+    } else {
+        while (head->next != NULL)
+            head = head->next;
+        head->next = item;
+    }
+    return(0);
+}
+
+/**
+ * Sort and deduplicate the name lengths of a prefix table.
+ *
+ * @param table  the prefix table
+ */
+static void
+xmlCatalogPrefixFinish(xmlCatalogPrefixTable *table) {
+    int i, j;
+
+    if (table->nbLengths <= 1)
+        return;
+    qsort(table->lengths, table->nbLengths, sizeof(int),
+          xmlCatalogCompareLengths);
+    for (i = 1, j = 1; i < table->nbLengths; i++) {
+        if (table->lengths[i] != table->lengths[j - 1])
+            table->lengths[j++] = table->lengths[i];
+    }
+    table->nbLengths = j;
+}
+
+/**
+ * Find the entries of a prefix table whose name is a prefix of `id`.
+ * If `longest` is set, only the first entry with the longest name
+ * is returned. Otherwise, all matches are returned in list order.
+ *
+ * @param table  the prefix table
+ * @param id  the identifier
+ * @param longest  only return the longest match
+ * @param out  pointer to the returned array, to be freed by the caller
+ * @returns the number of matches or -1 on error
+ */
+static int
+xmlCatalogPrefixMatch(xmlCatalogPrefixTable *table, const xmlChar *id,
+                      int longest, xmlCatalogPrefix ***out) {
+    xmlCatalogPrefix **matches = NULL;
+    xmlCatalogPrefix *item;
+    xmlChar *key;
+    int len, i, j, nb = 0, max = 0;
+
+    *out = NULL;
+    if (table->nbLengths == 0)
+        return(0);
+    key = xmlStrdup(id);
+    if (key == NULL)
+        return(-1);
+    len = xmlStrlen(key);
+
+    for (i = 0; i < table->nbLengths; i++) {
+        int l = table->lengths[i];
+        xmlChar save;
+
+        if (l > len)
+            continue;
+        save = key[l];
+        key[l] = 0;
+        item = xmlHashLookup(table->hash, key);
+        key[l] = save;
+
+        for (; item != NULL; item = item->next) {
+            if (nb >= max) {
+                xmlCatalogPrefix **tmp;
+                int newSize;
+
+                newSize = xmlGrowCapacity(max, sizeof(tmp[0]), 4,
+                                          XML_MAX_ITEMS);
+                if (newSize < 0)
+                    goto error;
+                tmp = xmlRealloc(matches, newSize * sizeof(tmp[0]));
+                if (tmp == NULL)
+                    goto error;
+                matches = tmp;
+                max = newSize;
+            }
+            /* Insert in list order */
+            for (j = nb; (j > 0) && (matches[j - 1]->pos > item->pos); j--)
+                matches[j] = matches[j - 1];
+            matches[j] = item;
+            nb++;
+            if (longest)
+                break;
+        }
+        if ((longest) && (nb > 0))
+            break;
+    }
+
+    xmlFree(key);
+    *out = matches;
+    return(nb);
+
+error:
+    xmlFree(key);
+    xmlFree(matches);
+    return(-1);
+}
+
+/**
+ * Build the index of a list of catalog entries.
+ *
+ * @param list  the first entry of the list
+ * @returns the index or NULL in case of error
+ */
+static xmlCatalogIndexPtr
+xmlCatalogBuildIndex(xmlCatalogEntryPtr list) {
+    xmlCatalogIndexPtr idx;
+    xmlCatalogEntryPtr cur;
+    xmlCatalogPrefixTable *tables[5];
+    xmlCatalogPrefixTable *table;
+    xmlCatalogPrefix *item;
+    int nbPrefixes = 0, nbNext = 0, pos, i;
+
+    idx = xmlMalloc(sizeof(*idx));
+    if (idx == NULL)
+        return(NULL);
+    memset(idx, 0, sizeof(*idx));
+    tables[0] = &idx->rewriteSystem;
+    tables[1] = &idx->rewriteURI;
+    tables[2] = &idx->delegateSystem;
+    tables[3] = &idx->delegatePublic;
+    tables[4] = &idx->delegateURI;
+
+    /*
+     * First count the entries of each table. Rewrite rules with an
+     * empty prefix never match.
+     */
+    for (cur = list; cur != NULL; cur = cur->next) {
+        switch (cur->type) {
+            case XML_CATA_REWRITE_SYSTEM:
+                if (xmlStrlen(cur->name) > 0) {
+                    idx->rewriteSystem.nbLengths++;
+                    nbPrefixes++;
+                }
+                break;
+            case XML_CATA_REWRITE_URI:
+                if (xmlStrlen(cur->name) > 0) {
+                    idx->rewriteURI.nbLengths++;
+                    nbPrefixes++;
+                }
+                break;
+            case XML_CATA_DELEGATE_SYSTEM:
+                idx->delegateSystem.nbLengths++;
+                idx->delegateURI.nbLengths++;
+                nbPrefixes += 2;
+                break;
+            case XML_CATA_DELEGATE_PUBLIC:
+                idx->delegatePublic.nbLengths++;
+                nbPrefixes++;
+                break;
+            case XML_CATA_DELEGATE_URI:
+                idx->delegateURI.nbLengths++;
+                nbPrefixes++;
+                break;
+            case XML_CATA_NEXT_CATALOG:
+                nbNext++;
+                break;
+            default:
+                break;
+        }
+    }
+    for (i = 0; i < 5; i++) {
+        if (tables[i]->nbLengths > 0) {
+            tables[i]->lengths = xmlMalloc(tables[i]->nbLengths *
+                                           sizeof(int));
+            if (tables[i]->lengths == NULL)
+                goto error;
+            tables[i]->nbLengths = 0;
+        }
+    }
+    if (nbPrefixes > 0) {
+        idx->prefixes = xmlMalloc(nbPrefixes * sizeof(xmlCatalogPrefix));
+        if (idx->prefixes == NULL)
+            goto error;
+    }
+    if (nbNext > 0) {
+        idx->nextCatalogs = xmlMalloc(nbNext * sizeof(xmlCatalogEntryPtr));
+        if (idx->nextCatalogs == NULL)
+            goto error;
+    }
+    idx->system = xmlHashCreate(0);
+    idx->pub = xmlHashCreate(0);
+    idx->uri = xmlHashCreate(0);
+    if ((idx->system == NULL) || (idx->pub == NULL) || (idx->uri == NULL))
+        goto error;
+
+    item = idx->prefixes;
+    for (cur = list, pos = 0; cur != NULL; cur = cur->next, pos++) {
+        xmlHashTablePtr exact = NULL;
+
+        table = NULL;
+        switch (cur->type) {
+            case XML_CATA_SYSTEM:
+                exact = idx->system;
+                break;
+            case XML_CATA_PUBLIC:
+                exact = idx->pub;
+                break;
+            case XML_CATA_URI:
+                exact = idx->uri;
+                break;
+            case XML_CATA_REWRITE_SYSTEM:
+                if (xmlStrlen(cur->name) > 0)
+                    table = &idx->rewriteSystem;
+                break;
+            case XML_CATA_REWRITE_URI:
+                if (xmlStrlen(cur->name) > 0)
+                    table = &idx->rewriteURI;
+                break;
+            case XML_CATA_DELEGATE_SYSTEM:
+                item->next = NULL;
+                item->entry = cur;
+                item->pos = pos;
+                if (xmlCatalogPrefixAdd(&idx->delegateURI, item) < 0)
+                    goto error;
+                item++;
+                table = &idx->delegateSystem;
+                break;
+            case XML_CATA_DELEGATE_PUBLIC:
+                table = &idx->delegatePublic;
+                break;
+            case XML_CATA_DELEGATE_URI:
+                table = &idx->delegateURI;
+                break;
+            case XML_CATA_NEXT_CATALOG:
+                idx->nextCatalogs[idx->nbNextCatalogs++] = cur;
+                break;
+            default:
+                break;
+        }
+        if ((exact != NULL) && (cur->name != NULL)) {
+            if (xmlHashAdd(exact, cur->name, cur) < 0)
+                goto error;
+        }
+        if (table != NULL) {
+            item->next = NULL;
+            item->entry = cur;
+            item->pos = pos;
+            if (xmlCatalogPrefixAdd(table, item) < 0)
+                goto error;
+            item++;
+        }
+    }
+    for (i = 0; i < 5; i++)
+        xmlCatalogPrefixFinish(tables[i]);
+
+    return(idx);
+
+error:
+    xmlCatalogFreeIndex(idx);
+    return(NULL);
+}
+
+/**
+ * Get the index of a list of catalog entries, building it if needed.
+ * The index must be released with #xmlCatalogReleaseIndex.
+ *
+ * @param list  the first entry of the list
+ * @returns the index or NULL in case of error
+ */
+static xmlCatalogIndexPtr
+xmlCatalogAcquireIndex(xmlCatalogEntryPtr list) {
+    xmlCatalogIndexPtr idx;
+
+    xmlRMutexLock(&xmlCatalogMutex);
+    if (list->index == NULL)
+        list->index = xmlCatalogBuildIndex(list);
+    idx = list->index;
+    if (idx != NULL)
+        idx->refs++;
+    xmlRMutexUnlock(&xmlCatalogMutex);
+
+    if (idx == NULL)
+        xmlCatalogErrMemory();
+    return(idx);
+}
+
+/**
+ * Release an index acquired with #xmlCatalogAcquireIndex.
+ *
+ * @param idx  the index
+ */
+static void
+xmlCatalogReleaseIndex(xmlCatalogIndexPtr idx) {
+    xmlRMutexLock(&xmlCatalogMutex);
+    idx->refs--;
+    if ((idx->stale) && (idx->refs == 0))
+        xmlCatalogFreeIndex(idx);
+    xmlRMutexUnlock(&xmlCatalogMutex);
+}
+
+/**
+ * Discard the index of a list of catalog entries after the list
+ * was modified. Lookups still using it free it when done.
+ *
+ * @param list  the first entry of the list
+ */
+static void
+xmlCatalogDiscardIndex(xmlCatalogEntryPtr list) {
+    xmlCatalogIndexPtr idx;
+
+    if (list == NULL)
+        return;
+    xmlRMutexLock(&xmlCatalogMutex);
+    idx = list->index;
+    list->index = NULL;
+    if (idx != NULL) {
+        idx->stale = 1;
+        if (idx->refs == 0)
+            xmlCatalogFreeIndex(idx);
+    }
+    xmlRMutexUnlock(&xmlCatalogMutex);
+}
+
 /************************************************************************
  *									*
  *			XML Catalog handling				*
@@ -1462,6 +2012,7 @@ xmlAddXMLCatalog(xmlCatalogEntryPtr catal, const xmlChar *type,
 	return(-1);
     }
 
+    xmlCatalogDiscardIndex(catal->children);
     cur = catal->children;
     /*
      * Might be a simple "update in place"
@@ -1528,6 +2079,8 @@ xmlDelXMLCatalog(xmlCatalogEntryPtr catal, const xmlChar *value) {
 	xmlFetchXMLCatalogFile(catal);
     }
 
+    xmlCatalogDiscardIndex(catal->children);
+
     /*
      * Scan the children
      */
@@ -1550,23 +2103,13 @@ xmlDelXMLCatalog(xmlCatalogEntryPtr catal, const xmlChar *value) {
     return(ret);
 }
 
-/**
- * Do a complete resolution lookup of an External Identifier for a
- * list of catalog entries.
- *
- * Implements (or tries to) 7.1. External Identifier Resolution
- * from http://www.oasis-open.org/committees/entity/spec-2001-08-06.html
- *
- * @param catal  a catalog list
- * @param pubID  the public ID string
- * @param sysID  the system ID string
- * @returns the URI of the resource or NULL if not found
- */
 static xmlChar *
-xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
-	              const xmlChar *sysID) {
+xmlCatalogXMLResolveIndexed(xmlCatalogEntryPtr catal, xmlCatalogIndexPtr idx,
+                            const xmlChar *pubID, const xmlChar *sysID) {
     xmlChar *ret = NULL;
     xmlCatalogEntryPtr cur;
+    xmlCatalogPrefix **matches;
+    int nbMatches, m;
     int haveDelegate = 0;
     int haveNext = 0;
 
@@ -1586,41 +2129,28 @@ xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
      */
     if (sysID != NULL) {
 	xmlCatalogEntryPtr rewrite = NULL;
-	int lenrewrite = 0, len;
-	cur = catal;
-	haveDelegate = 0;
-	while (cur != NULL) {
-	    switch (cur->type) {
-		case XML_CATA_SYSTEM:
-		    if (xmlStrEqual(sysID, cur->name)) {
-			if (xmlDebugCatalogs)
-			    xmlCatalogPrintDebug(
-				    "Found system match %s, using %s\n",
-				            cur->name, cur->URL);
-			catal->depth--;
-			return(xmlStrdup(cur->URL));
-		    }
-		    break;
-		case XML_CATA_REWRITE_SYSTEM:
-		    len = xmlStrlen(cur->name);
-		    if ((len > lenrewrite) &&
-			(!xmlStrncmp(sysID, cur->name, len))) {
-			lenrewrite = len;
-			rewrite = cur;
-		    }
-		    break;
-		case XML_CATA_DELEGATE_SYSTEM:
-		    if (!xmlStrncmp(sysID, cur->name, xmlStrlen(cur->name)))
-			haveDelegate++;
-		    break;
-		case XML_CATA_NEXT_CATALOG:
-		    haveNext++;
-		    break;
-		default:
-		    break;
-	    }
-	    cur = cur->next;
+	int lenrewrite = 0;
+
+	if (idx->nbNextCatalogs > 0)
+	    haveNext++;
+	cur = xmlHashLookup(idx->system, sysID);
+	if (cur != NULL) {
+	    if (xmlDebugCatalogs)
+		xmlCatalogPrintDebug(
+			"Found system match %s, using %s\n",
+				cur->name, cur->URL);
+	    catal->depth--;
+	    return(xmlStrdup(cur->URL));
+	}
+	nbMatches = xmlCatalogPrefixMatch(&idx->rewriteSystem, sysID, 1,
+	                                  &matches);
+	if (nbMatches < 0)
+	    goto error;
+	if (nbMatches > 0) {
+	    rewrite = matches[0]->entry;
+	    lenrewrite = xmlStrlen(rewrite->name);
 	}
+	xmlFree(matches);
 	if (rewrite != NULL) {
 	    if (xmlDebugCatalogs)
 		xmlCatalogPrintDebug(
@@ -1631,6 +2161,14 @@ xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
 	    catal->depth--;
 	    return(ret);
 	}
+	nbMatches = xmlCatalogPrefixMatch(&idx->delegateSystem, sysID, 0,
+	                                  &matches);
+	if (nbMatches < 0)
+	    goto error;
+	haveDelegate = 0;
+	for (m = 0; m < nbMatches; m++)
+	    if (matches[m]->entry->type == XML_CATA_DELEGATE_SYSTEM)
+		haveDelegate++;
 	if (haveDelegate) {
 	    const xmlChar *delegates[MAX_DELEGATE];
 	    int nbList = 0, i;
@@ -1639,17 +2177,14 @@ xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
 	     * Assume the entries have been sorted by decreasing substring
 	     * matches when the list was produced.
 	     */
-	    cur = catal;
-	    while (cur != NULL) {
-		if ((cur->type == XML_CATA_DELEGATE_SYSTEM) &&
-		    (!xmlStrncmp(sysID, cur->name, xmlStrlen(cur->name)))) {
+	    for (m = 0; m < nbMatches; m++) {
+		cur = matches[m]->entry;
+		if (cur->type == XML_CATA_DELEGATE_SYSTEM) {
 		    for (i = 0;i < nbList;i++)
 			if (xmlStrEqual(cur->URL, delegates[i]))
 			    break;
-		    if (i < nbList) {
-			cur = cur->next;
+		    if (i < nbList)
 			continue;
-		    }
 		    if (nbList < MAX_DELEGATE)
 			delegates[nbList++] = cur->URL;
 
@@ -1663,51 +2198,45 @@ xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
 			ret = xmlCatalogListXMLResolve(
 				cur->children, NULL, sysID);
 			if (ret != NULL) {
+			    xmlFree(matches);
 			    catal->depth--;
 			    return(ret);
 			}
 		    }
 		}
-		cur = cur->next;
 	    }
 	    /*
 	     * Apply the cut algorithm explained in 4/
 	     */
+	    xmlFree(matches);
 	    catal->depth--;
 	    return(XML_CATAL_BREAK);
 	}
+	xmlFree(matches);
     }
     /*
      * Then tries 5/ 6/ if a public ID is provided
      */
     if (pubID != NULL) {
-	cur = catal;
-	haveDelegate = 0;
-	while (cur != NULL) {
-	    switch (cur->type) {
-		case XML_CATA_PUBLIC:
-		    if (xmlStrEqual(pubID, cur->name)) {
-			if (xmlDebugCatalogs)
-			    xmlCatalogPrintDebug(
-				    "Found public match %s\n", cur->name);
-			catal->depth--;
-			return(xmlStrdup(cur->URL));
-		    }
-		    break;
-		case XML_CATA_DELEGATE_PUBLIC:
-		    if (!xmlStrncmp(pubID, cur->name, xmlStrlen(cur->name)) &&
-			(cur->prefer == XML_CATA_PREFER_PUBLIC))
-			haveDelegate++;
-		    break;
-		case XML_CATA_NEXT_CATALOG:
-		    if (sysID == NULL)
-			haveNext++;
-		    break;
-		default:
-		    break;
-	    }
-	    cur = cur->next;
+	if ((sysID == NULL) && (idx->nbNextCatalogs > 0))
+	    haveNext++;
+	cur = xmlHashLookup(idx->pub, pubID);
+	if (cur != NULL) {
+	    if (xmlDebugCatalogs)
+		xmlCatalogPrintDebug(
+			"Found public match %s\n", cur->name);
+	    catal->depth--;
+	    return(xmlStrdup(cur->URL));
 	}
+	nbMatches = xmlCatalogPrefixMatch(&idx->delegatePublic, pubID, 0,
+	                                  &matches);
+	if (nbMatches < 0)
+	    goto error;
+	haveDelegate = 0;
+	for (m = 0; m < nbMatches; m++)
+	    if ((matches[m]->entry->type == XML_CATA_DELEGATE_PUBLIC) &&
+		(matches[m]->entry->prefer == XML_CATA_PREFER_PUBLIC))
+		haveDelegate++;
 	if (haveDelegate) {
 	    const xmlChar *delegates[MAX_DELEGATE];
 	    int nbList = 0, i;
@@ -1716,19 +2245,16 @@ xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
 	     * Assume the entries have been sorted by decreasing substring
 	     * matches when the list was produced.
 	     */
-	    cur = catal;
-	    while (cur != NULL) {
+	    for (m = 0; m < nbMatches; m++) {
+		cur = matches[m]->entry;
 		if ((cur->type == XML_CATA_DELEGATE_PUBLIC) &&
-		    (cur->prefer == XML_CATA_PREFER_PUBLIC) &&
-		    (!xmlStrncmp(pubID, cur->name, xmlStrlen(cur->name)))) {
+		    (cur->prefer == XML_CATA_PREFER_PUBLIC)) {
 
 		    for (i = 0;i < nbList;i++)
 			if (xmlStrEqual(cur->URL, delegates[i]))
 			    break;
-		    if (i < nbList) {
-			cur = cur->next;
+		    if (i < nbList)
 			continue;
-		    }
 		    if (nbList < MAX_DELEGATE)
 			delegates[nbList++] = cur->URL;
 
@@ -1742,23 +2268,25 @@ xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
 			ret = xmlCatalogListXMLResolve(
 				cur->children, pubID, NULL);
 			if (ret != NULL) {
+			    xmlFree(matches);
 			    catal->depth--;
 			    return(ret);
 			}
 		    }
 		}
-		cur = cur->next;
 	    }
 	    /*
 	     * Apply the cut algorithm explained in 4/
 	     */
+	    xmlFree(matches);
 	    catal->depth--;
 	    return(XML_CATAL_BREAK);
 	}
+	xmlFree(matches);
     }
     if (haveNext) {
-	cur = catal;
-	while (cur != NULL) {
+	for (m = 0; m < idx->nbNextCatalogs; m++) {
+	    cur = idx->nextCatalogs[m];
 	    if (cur->type == XML_CATA_NEXT_CATALOG) {
 		if (cur->children == NULL) {
 		    xmlFetchXMLCatalogFile(cur);
@@ -1773,39 +2301,54 @@ xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
 		    }
 		}
 	    }
-	    cur = cur->next;
 	}
     }
 
     catal->depth--;
     return(NULL);
+
+error:
+    xmlCatalogErrMemory();
+    catal->depth--;
+    return(NULL);
 }
 
 /**
  * Do a complete resolution lookup of an External Identifier for a
  * list of catalog entries.
  *
- * Implements (or tries to) 7.2.2. URI Resolution
+ * Implements (or tries to) 7.1. External Identifier Resolution
  * from http://www.oasis-open.org/committees/entity/spec-2001-08-06.html
  *
  * @param catal  a catalog list
- * @param URI  the URI
+ * @param pubID  the public ID string
+ * @param sysID  the system ID string
  * @returns the URI of the resource or NULL if not found
  */
 static xmlChar *
-xmlCatalogXMLResolveURI(xmlCatalogEntryPtr catal, const xmlChar *URI) {
+xmlCatalogXMLResolve(xmlCatalogEntryPtr catal, const xmlChar *pubID,
+	              const xmlChar *sysID) {
+    xmlCatalogIndexPtr idx;
+    xmlChar *ret;
+
+    idx = xmlCatalogAcquireIndex(catal);
+    if (idx == NULL)
+        return(NULL);
+    ret = xmlCatalogXMLResolveIndexed(catal, idx, pubID, sysID);
+    xmlCatalogReleaseIndex(idx);
+    return(ret);
+}
+
+static xmlChar *
+xmlCatalogXMLResolveURIIndexed(xmlCatalogEntryPtr catal,
+                               xmlCatalogIndexPtr idx, const xmlChar *URI) {
     xmlChar *ret = NULL;
     xmlCatalogEntryPtr cur;
-    int haveDelegate = 0;
-    int haveNext = 0;
     xmlCatalogEntryPtr rewrite = NULL;
-    int lenrewrite = 0, len;
-
-    if (catal == NULL)
-	return(NULL);
-
-    if (URI == NULL)
-	return(NULL);
+    xmlCatalogPrefix **matches;
+    int nbMatches, m;
+    int haveDelegate = 0;
+    int lenrewrite = 0;
 
     if (catal->depth > MAX_CATAL_DEPTH) {
 	xmlCatalogErr(catal, NULL, XML_CATALOG_RECURSION,
@@ -1817,38 +2360,21 @@ xmlCatalogXMLResolveURI(xmlCatalogEntryPtr catal, const xmlChar *URI) {
     /*
      * First tries steps 2/ 3/ 4/ if a system ID is provided.
      */
-    cur = catal;
-    haveDelegate = 0;
-    while (cur != NULL) {
-	switch (cur->type) {
-	    case XML_CATA_URI:
-		if (xmlStrEqual(URI, cur->name)) {
-		    if (xmlDebugCatalogs)
-			xmlCatalogPrintDebug(
-				"Found URI match %s\n", cur->name);
-		    return(xmlStrdup(cur->URL));
-		}
-		break;
-	    case XML_CATA_REWRITE_URI:
-		len = xmlStrlen(cur->name);
-		if ((len > lenrewrite) &&
-		    (!xmlStrncmp(URI, cur->name, len))) {
-		    lenrewrite = len;
-		    rewrite = cur;
-		}
-		break;
-	    case XML_CATA_DELEGATE_URI:
-		if (!xmlStrncmp(URI, cur->name, xmlStrlen(cur->name)))
-		    haveDelegate++;
-		break;
-	    case XML_CATA_NEXT_CATALOG:
-		haveNext++;
-		break;
-	    default:
-		break;
-	}
-	cur = cur->next;
+    cur = xmlHashLookup(idx->uri, URI);
+    if (cur != NULL) {
+	if (xmlDebugCatalogs)
+	    xmlCatalogPrintDebug(
+		    "Found URI match %s\n", cur->name);
+	return(xmlStrdup(cur->URL));
+    }
+    nbMatches = xmlCatalogPrefixMatch(&idx->rewriteURI, URI, 1, &matches);
+    if (nbMatches < 0)
+	goto error;
+    if (nbMatches > 0) {
+	rewrite = matches[0]->entry;
+	lenrewrite = xmlStrlen(rewrite->name);
     }
+    xmlFree(matches);
     if (rewrite != NULL) {
 	if (xmlDebugCatalogs)
 	    xmlCatalogPrintDebug(
@@ -1858,6 +2384,12 @@ xmlCatalogXMLResolveURI(xmlCatalogEntryPtr catal, const xmlChar *URI) {
 	    ret = xmlStrcat(ret, &URI[lenrewrite]);
 	return(ret);
     }
+    nbMatches = xmlCatalogPrefixMatch(&idx->delegateURI, URI, 0, &matches);
+    if (nbMatches < 0)
+	goto error;
+    for (m = 0; m < nbMatches; m++)
+	if (matches[m]->entry->type == XML_CATA_DELEGATE_URI)
+	    haveDelegate++;
     if (haveDelegate) {
 	const xmlChar *delegates[MAX_DELEGATE];
 	int nbList = 0, i;
@@ -1866,18 +2398,15 @@ xmlCatalogXMLResolveURI(xmlCatalogEntryPtr catal, const xmlChar *URI) {
 	 * Assume the entries have been sorted by decreasing substring
 	 * matches when the list was produced.
 	 */
-	cur = catal;
-	while (cur != NULL) {
-	    if (((cur->type == XML_CATA_DELEGATE_SYSTEM) ||
-	         (cur->type == XML_CATA_DELEGATE_URI)) &&
-		(!xmlStrncmp(URI, cur->name, xmlStrlen(cur->name)))) {
+	for (m = 0; m < nbMatches; m++) {
+	    cur = matches[m]->entry;
+	    if ((cur->type == XML_CATA_DELEGATE_SYSTEM) ||
+	        (cur->type == XML_CATA_DELEGATE_URI)) {
 		for (i = 0;i < nbList;i++)
 		    if (xmlStrEqual(cur->URL, delegates[i]))
 			break;
-		if (i < nbList) {
-		    cur = cur->next;
+		if (i < nbList)
 		    continue;
-		}
 		if (nbList < MAX_DELEGATE)
 		    delegates[nbList++] = cur->URL;
 
@@ -1890,35 +2419,69 @@ xmlCatalogXMLResolveURI(xmlCatalogEntryPtr catal, const xmlChar *URI) {
 				"Trying URI delegate %s\n", cur->URL);
 		    ret = xmlCatalogListXMLResolveURI(
 			    cur->children, URI);
-		    if (ret != NULL)
+		    if (ret != NULL) {
+			xmlFree(matches);
 			return(ret);
+		    }
 		}
 	    }
-	    cur = cur->next;
 	}
 	/*
 	 * Apply the cut algorithm explained in 4/
 	 */
+	xmlFree(matches);
 	return(XML_CATAL_BREAK);
     }
-    if (haveNext) {
-	cur = catal;
-	while (cur != NULL) {
-	    if (cur->type == XML_CATA_NEXT_CATALOG) {
-		if (cur->children == NULL) {
-		    xmlFetchXMLCatalogFile(cur);
-		}
-		if (cur->children != NULL) {
-		    ret = xmlCatalogListXMLResolveURI(cur->children, URI);
-		    if (ret != NULL)
-			return(ret);
-		}
+    xmlFree(matches);
+    for (m = 0; m < idx->nbNextCatalogs; m++) {
+	cur = idx->nextCatalogs[m];
+	if (cur->type == XML_CATA_NEXT_CATALOG) {
+	    if (cur->children == NULL) {
+		xmlFetchXMLCatalogFile(cur);
+	    }
+	    if (cur->children != NULL) {
+		ret = xmlCatalogListXMLResolveURI(cur->children, URI);
+		if (ret != NULL)
+		    return(ret);
 	    }
-	    cur = cur->next;
 	}
     }
 
     return(NULL);
+
+error:
+    xmlCatalogErrMemory();
+    return(NULL);
+}
+
+/**
+ * Do a complete resolution lookup of an External Identifier for a
+ * list of catalog entries.
+ *
+ * Implements (or tries to) 7.2.2. URI Resolution
+ * from http://www.oasis-open.org/committees/entity/spec-2001-08-06.html
+ *
+ * @param catal  a catalog list
+ * @param URI  the URI
+ * @returns the URI of the resource or NULL if not found
+ */
+static xmlChar *
+xmlCatalogXMLResolveURI(xmlCatalogEntryPtr catal, const xmlChar *URI) {
+    xmlCatalogIndexPtr idx;
+    xmlChar *ret;
+
+    if (catal == NULL)
+	return(NULL);
+
+    if (URI == NULL)
+	return(NULL);
+
+    idx = xmlCatalogAcquireIndex(catal);
+    if (idx == NULL)
+        return(NULL);
+    ret = xmlCatalogXMLResolveURIIndexed(catal, idx, URI);
+    xmlCatalogReleaseIndex(idx);
+    return(ret);
 }
 
 /**
@@ -2668,6 +3231,8 @@ xmlExpandCatalog(xmlCatalogPtr catal, const char *filename)
     if ((catal == NULL) || (filename == NULL))
 	return(-1);
 
+    xmlCatalogInvalidateMemo();
+
 #ifdef LIBXML_SGML_CATALOG_ENABLED
     if (catal->type == XML_SGML_CATALOG_TYPE) {
 	xmlChar *content;
@@ -2732,9 +3297,12 @@ xmlACatalogResolveSystem(xmlCatalog *catal, const xmlChar *sysID) {
     } else
 #endif /* LIBXML_SGML_CATALOG_ENABLED */
     {
+        if (xmlCatalogMemoLookup(catal, "system", NULL, sysID, &ret))
+            return(ret);
 	ret = xmlCatalogListXMLResolve(catal->xml, NULL, sysID);
 	if (ret == XML_CATAL_BREAK)
 	    ret = NULL;
+        xmlCatalogMemoStore(catal, "system", NULL, sysID, ret);
     }
     return(ret);
 }
@@ -2770,9 +3338,12 @@ xmlACatalogResolvePublic(xmlCatalog *catal, const xmlChar *pubID) {
     } else
 #endif /* LIBXML_SGML_CATALOG_ENABLED */
     {
+        if (xmlCatalogMemoLookup(catal, "public", pubID, NULL, &ret))
+            return(ret);
 	ret = xmlCatalogListXMLResolve(catal->xml, pubID, NULL);
 	if (ret == XML_CATAL_BREAK)
 	    ret = NULL;
+        xmlCatalogMemoStore(catal, "public", pubID, NULL, ret);
     }
     return(ret);
 }
@@ -2820,9 +3391,12 @@ xmlACatalogResolve(xmlCatalog *catal, const xmlChar * pubID,
     } else
 #endif /* LIBXML_SGML_CATALOG_ENABLED */
     {
+        if (xmlCatalogMemoLookup(catal, "resolve", pubID, sysID, &ret))
+            return(ret);
         ret = xmlCatalogListXMLResolve(catal->xml, pubID, sysID);
 	if (ret == XML_CATAL_BREAK)
 	    ret = NULL;
+        xmlCatalogMemoStore(catal, "resolve", pubID, sysID, ret);
     }
     return (ret);
 }
@@ -2858,9 +3432,12 @@ xmlACatalogResolveURI(xmlCatalog *catal, const xmlChar *URI) {
     } else
 #endif /* LIBXML_SGML_CATALOG_ENABLED */
     {
+        if (xmlCatalogMemoLookup(catal, "uri", NULL, URI, &ret))
+            return(ret);
 	ret = xmlCatalogListXMLResolveURI(catal->xml, URI);
 	if (ret == XML_CATAL_BREAK)
 	    ret = NULL;
+        xmlCatalogMemoStore(catal, "uri", NULL, URI, ret);
     }
     return(ret);
 }
@@ -2911,6 +3488,8 @@ xmlACatalogAdd(xmlCatalog *catal, const xmlChar * type,
     if (catal == NULL)
 	return(-1);
 
+    xmlCatalogInvalidateMemo();
+
 #ifdef LIBXML_SGML_CATALOG_ENABLED
     if (catal->type == XML_SGML_CATALOG_TYPE) {
         xmlCatalogEntryType cattype;
@@ -2951,6 +3530,8 @@ xmlACatalogRemove(xmlCatalog *catal, const xmlChar *value) {
     if ((catal == NULL) || (value == NULL))
 	return(-1);
 
+    xmlCatalogInvalidateMemo();
+
 #ifdef LIBXML_SGML_CATALOG_ENABLED
     if (catal->type == XML_SGML_CATALOG_TYPE) {
 	res = xmlHashRemoveEntry(catal->sgml, value, xmlFreeCatalogEntry);
@@ -3047,6 +3628,7 @@ xmlInitCatalogInternal(void) {
     if (getenv("XML_DEBUG_CATALOG"))
 	xmlDebugCatalogs = 1;
     xmlInitRMutex(&xmlCatalogMutex);
+    xmlInitMutex(&xmlCatalogMemoMutex);
 }
 
 /**
@@ -3206,6 +3788,10 @@ xmlCatalogCleanup(void) {
     xmlDefaultCatalog = NULL;
     xmlDebugCatalogs = 0;
     xmlCatalogInitialized = 0;
+    xmlMutexLock(&xmlCatalogMemoMutex);
+    xmlCatalogMemoMax = 0;
+    xmlCatalogGeneration++;
+    xmlMutexUnlock(&xmlCatalogMemoMutex);
     xmlRMutexUnlock(&xmlCatalogMutex);
 }
 
@@ -3215,6 +3801,7 @@ xmlCatalogCleanup(void) {
 void
 xmlCleanupCatalogInternal(void) {
     xmlCleanupRMutex(&xmlCatalogMutex);
+    xmlCleanupMutex(&xmlCatalogMemoMutex);
 }
 
 /**
@@ -3473,9 +4060,48 @@ xmlCatalogSetDefaultPrefer(xmlCatalogPrefer prefer) {
 	}
     }
     xmlCatalogDefaultPrefer = prefer;
+    /* Affects catalogs which are loaded lazily */
+    xmlCatalogInvalidateMemo();
     return(ret);
 }
 
+/**
+ * Enable or resize the memo cache of catalog lookups.
+ *
+ * When enabled, the results of resolving public IDs, system IDs and
+ * URIs with an XML catalog are remembered, including lookups which
+ * found nothing. Repeated lookups, typically of the same DTDs and
+ * entities from many parsers, don't have to walk the catalog entries
+ * again. Each catalog remembers at most `maxEntries` results and
+ * starts over when full. Changes to catalogs made through the
+ * catalog API invalidate all memoized results.
+ *
+ * Memoized results aren't used while catalog debugging is enabled.
+ * The cache is disabled by default, a `maxEntries` of 0 disables it
+ * and frees the memoized results of the default catalog.
+ *
+ * This function is thread-safe.
+ *
+ * @since 2.16.0
+ *
+ * @param maxEntries  maximum number of results per catalog
+ */
+void
+xmlCatalogSetMemoLimit(int maxEntries) {
+    xmlInitParser();
+
+    xmlRMutexLock(&xmlCatalogMutex);
+    xmlMutexLock(&xmlCatalogMemoMutex);
+    xmlCatalogMemoMax = (maxEntries > 0) ? maxEntries : 0;
+    xmlCatalogGeneration++;
+    if ((xmlCatalogMemoMax == 0) && (xmlDefaultCatalog != NULL)) {
+        xmlHashFree(xmlDefaultCatalog->memo, xmlCatalogFreeMemo);
+        xmlDefaultCatalog->memo = NULL;
+    }
+    xmlMutexUnlock(&xmlCatalogMemoMutex);
+    xmlRMutexUnlock(&xmlCatalogMutex);
+}
+
 /**
  * Used to set the debug level for catalog operation, 0 disable
  * debugging, 1 enable it
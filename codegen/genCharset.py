@@ -60,9 +60,23 @@ def genTranscodeTable(out, name, chars):
 
         o += 1
 
-    out.write('static const unsigned short ')
-    out.write(f'xmlunicodetable_{name} [128] = {{\n')
-    printHexTable(out, 4, chars)
+    # Precomputed UTF-8 sequences for bytes 0x80-0xFF: the length
+    # followed by up to three bytes. A zero length marks undefined
+    # code points.
+    utf8 = []
+    for cp in chars:
+        if cp == 0:
+            seq = []
+        elif cp < 0x0800:
+            seq = [ 0xC0 | (cp >> 6), 0x80 | (cp & 0x3F) ]
+        else:
+            seq = [ 0xE0 | (cp >> 12), 0x80 | ((cp >> 6) & 0x3F),
+                    0x80 | (cp & 0x3F) ]
+        utf8 += [ len(seq) ] + seq + [ 0 ] * (3 - len(seq))
+
+    out.write('static const unsigned char ')
+    out.write(f'xmlutf8table_{name} [128 * 4] = {{\n')
+    printHexTable(out, 2, utf8)
     out.write('};\n\n')
 
     num_chunks = len(data) // 64
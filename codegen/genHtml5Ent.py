@@ -2,25 +2,29 @@
 
 import json
 import sys
-from dataclasses import dataclass
 
-# The basic idea is to find named character references using binary
-# search. Since entity strings may not have a terminator, this doesn't
-# work if one entity string is a prefix of another. In this case,
-# we branch to a subtable after matching the prefix.
-#
-# We create separate initial tables based on the first character
-# of the entity name.
+# Named character references are matched with a trie, so the longest
+# match can be found in a single pass over the input. Entity names
+# don't contain the trailing semicolon. A node with a value matches
+# if the next character is a semicolon or if the entity may also be
+# used without semicolon (legacy entities).
 #
 # The following tables are generated:
 #
-# htmlEntAlpha:   start and end of initial tables, indexing into
-#                 htmlEntValues
-# htmlEntValues:  concatenation of all table values, which index into
-#                 htmlEntStrings
-# htmlEntStrings: variable sized records containing entity name,
-#                 replacement and optionally the position of a
-#                 subtable
+# htmlEntAlpha:   offset of the trie node after the first character
+#                 of the entity name, indexed by character & 63
+# htmlEntTrie:    variable sized trie nodes
+# htmlEntRepl:    replacement strings prefixed with their length
+#
+# Trie node layout:
+#
+# - Header byte: number of children (6 bits), ENT_F_VALUE (0x40) and
+#   ENT_F_LEGACY (0x80)
+# - If ENT_F_VALUE is set: offset into htmlEntRepl (2 bytes, little
+#   endian)
+# - Sorted child characters
+# - If there's a single child: the child node
+# - Otherwise: offsets of child nodes (2 bytes each, little endian)
 
 try:
     with open('entities.json') as json_data:
@@ -30,6 +34,9 @@ except FileNotFoundError:
           'https://html.spec.whatwg.org/entities.json')
     sys.exit(1)
 
+ENT_F_VALUE = 0x40
+ENT_F_LEGACY = 0x80
+
 def to_cchars(s):
     r = []
 
@@ -42,113 +49,79 @@ def to_cchars(s):
 
     return r
 
-@dataclass
-class PrefixStackEntry:
-    prefix: str
-    table_id: int
-
-@dataclass
-class AlphaFixup:
-    table_id: int
-    char: int
-
-@dataclass
-class StringFixup:
-    table_id: int
-    string_index: int
-    super_table_id: int
-    super_offset: int
-
-# Remove entity strings without trailing semicolon
-keys = (key for key in ents.keys() if key.endswith(';'))
-
-# Sort entity strings
-keys = sorted(keys, key=lambda k: k[1:-1])
-
-strings = []
-tables = []
-prefix_stack = []
-alpha_fixups = []
-string_fixups = []
-for i in range(64):
-    tables.append([])
-
-for i, key in enumerate(keys):
+class Node:
+    def __init__(self):
+        self.children = {}
+        self.repl = None
+        self.legacy = False
+
+# Build trie from entity strings with trailing semicolon
+
+root = Node()
+
+for key in ents.keys():
+    if not key.endswith(';'):
+        continue
+
     name = key[1:-1]
+    node = root
+    for c in name:
+        node = node.children.setdefault(c, Node())
+
+    node.repl = ents[key]['characters']
+    node.legacy = key[:-1] in ents
+
+# Replacement strings
+
+repl = []
+repl_offsets = {}
 
-    next_name = None
-    if i + 1 < len(keys):
-        next_name = keys[i+1][1:-1]
-
-    while prefix_stack and not name.startswith(prefix_stack[-1].prefix):
-        prefix_stack.pop()
-
-    # First character is initial prefix
-    if not prefix_stack:
-        table_id = len(tables)
-        tables.append([])
-
-        prefix_stack.append(PrefixStackEntry(name[0], table_id))
-        alpha_fixups.append(AlphaFixup(table_id, ord(name[0]) % 64))
-
-    string_index = len(strings)
-    table = tables[prefix_stack[-1].table_id]
-    table_index = len(table)
-    table.append(string_index)
-
-    name_offset = len(prefix_stack[-1].prefix)
-    name_chars = to_cchars(name[name_offset:])
-    repl_chars = to_cchars(ents[key]['characters'])
-    semicolon_flag = 0
-    if key[:-1] in ents:
-        semicolon_flag = 0x80
-
-    if next_name and next_name.startswith(name):
-        # Create subtable
-
-        strings += [
-            len(name_chars) | semicolon_flag | 0x40, *name_chars,
-            0, 0, # subtable position, to be fixed up
-            len(repl_chars), *repl_chars,
-        ]
-
-        table_id = len(tables)
-        tables.append([])
-
-        fixup_index = string_index + 1 + len(name_chars)
-        string_fixups.append(StringFixup(
-            table_id, fixup_index, prefix_stack[-1].table_id, table_index,
-        ))
-
-        prefix_stack.append(PrefixStackEntry(name, table_id))
-    else:
-        strings += [
-            len(name_chars) | semicolon_flag, *name_chars,
-            len(repl_chars), *repl_chars,
-        ]
-
-# Concat tables and record ranges
-ranges = [ 0 ]
-values = []
-for table in tables:
-    values += table
-    ranges.append(len(values))
-
-# Create alpha table
-alpha = [ 0 ] * (59 * 3)
-for fixup in alpha_fixups:
-    table_id, c = fixup.table_id, fixup.char
-    start = ranges[table_id]
-    end = ranges[table_id+1]
-    alpha[c*3:c*3+3] = [ start & 0xFF, start >> 8, end - start ]
-
-# Fix up subtable positions
-for fixup in string_fixups:
-    table_id, i = fixup.table_id, fixup.string_index
-    start = ranges[table_id]
-    end = ranges[table_id+1]
-    super_index = ranges[fixup.super_table_id] + fixup.super_offset
-    strings[i:i+2] = [ start - super_index, end - start ]
+for key in sorted(ents.keys()):
+    chars = ents[key]['characters']
+    if chars not in repl_offsets:
+        repl_offsets[chars] = len(repl)
+        cchars = to_cchars(chars)
+        repl += [ len(cchars), *cchars ]
+
+# Serialize trie nodes depth-first
+
+trie = []
+
+def emit_node(node):
+    offset = len(trie)
+    keys = sorted(node.children.keys())
+
+    header = len(keys)
+    if node.repl is not None:
+        header |= ENT_F_VALUE
+        if node.legacy:
+            header |= ENT_F_LEGACY
+    trie.append(header)
+
+    if node.repl is not None:
+        r = repl_offsets[node.repl]
+        trie.extend([ r & 0xFF, r >> 8 ])
+
+    trie.extend(to_cchars(''.join(keys)))
+
+    if len(keys) == 1:
+        emit_node(node.children[keys[0]])
+    elif len(keys) > 1:
+        fixup = len(trie)
+        trie.extend([ 0, 0 ] * len(keys))
+        for i, c in enumerate(keys):
+            child = emit_node(node.children[c])
+            trie[fixup+i*2:fixup+i*2+2] = [ child & 0xFF, child >> 8 ]
+
+    return offset
+
+alpha = [ 0 ] * 64
+for c in sorted(root.children.keys()):
+    alpha[ord(c) % 64] = emit_node(root.children[c])
+
+if len(trie) > 0xFFFF or len(repl) > 0xFFFF:
+    print('tables too large')
+    sys.exit(1)
 
 # Print tables
 
@@ -165,6 +138,6 @@ def gen_table(ctype, cname, values, fmt, elems_per_line):
     return f'static const {ctype} {cname}[{count}] = {{{r}\n}};\n\n'
 
 with open('codegen/html5ent.inc', 'w') as out:
-    out.write(gen_table('unsigned char', 'htmlEntAlpha', alpha, '%3d', 15))
-    out.write(gen_table('unsigned short', 'htmlEntValues', values, '%5d', 10))
-    out.write(gen_table('unsigned char', 'htmlEntStrings', strings, '%3s', 15))
+    out.write(gen_table('unsigned short', 'htmlEntAlpha', alpha, '%5d', 10))
+    out.write(gen_table('unsigned char', 'htmlEntTrie', trie, '%3s', 15))
+    out.write(gen_table('unsigned char', 'htmlEntRepl', repl, '%3s', 15))
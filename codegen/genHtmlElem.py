@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+
+import re
+
+# Element lookup tables for the HTML 4 parser.
+#
+# Tag names are mapped to a small index with a perfect hash, so
+# htmlTagLookup and the auto-close checks don't have to search sorted
+# string tables. Indices below HTML_ELEM_COUNT match the entries of
+# html40ElementTable in HTMLparser.c, which is read to get the element
+# names. Other tags only appear in the auto-close rules.
+#
+# The following tables are generated:
+#
+# htmlTagHashTab:    index + 1 of the tag in the hash slot, 0 if empty
+# htmlTagNames:      names of all tags
+# htmlStartCloseTab: bit matrix, bit `new` of row `old` is set if a
+#                    start tag `new` implies the end of element `old`
+#
+# The hash is FNV-1a over the ASCII-lowercased name, starting with
+# HTML_TAG_HASH_SEED. The slot is given by the upper bits of the hash.
+
+# start tags that imply the end of current element
+start_close = [
+    [ 'a', ['a', 'fieldset', 'table', 'td', 'th'] ],
+    [ 'address', ['dd', 'dl', 'dt', 'form', 'li', 'ul'] ],
+    [ 'b', ['center', 'p', 'td', 'th'] ],
+    [ 'big', ['p'] ],
+    [ 'caption', ['col', 'colgroup', 'tbody', 'tfoot', 'thead', 'tr'] ],
+    [ 'col', ['col', 'colgroup', 'tbody', 'tfoot', 'thead', 'tr'] ],
+    [ 'colgroup', ['colgroup', 'tbody', 'tfoot', 'thead', 'tr'] ],
+    [ 'dd', ['dt'] ],
+    [ 'dir', ['dd', 'dl', 'dt', 'form', 'ul'] ],
+    [ 'dl', ['form', 'li'] ],
+    [ 'dt', ['dd', 'dl'] ],
+    [ 'font', ['center', 'td', 'th'] ],
+    [ 'form', ['form'] ],
+    [ 'h1', ['fieldset', 'form', 'li', 'p', 'table'] ],
+    [ 'h2', ['fieldset', 'form', 'li', 'p', 'table'] ],
+    [ 'h3', ['fieldset', 'form', 'li', 'p', 'table'] ],
+    [ 'h4', ['fieldset', 'form', 'li', 'p', 'table'] ],
+    [ 'h5', ['fieldset', 'form', 'li', 'p', 'table'] ],
+    [ 'h6', ['fieldset', 'form', 'li', 'p', 'table'] ],
+    [ 'head', ['a', 'abbr', 'acronym', 'address', 'b', 'bdo', 'big',
+        'blockquote', 'body', 'br', 'center', 'cite', 'code', 'dd', 'dfn',
+        'dir', 'div', 'dl', 'dt', 'em', 'fieldset', 'font', 'form',
+        'frameset', 'h1', 'h2', 'h3', 'h4', 'h5', 'h6', 'hr', 'i', 'iframe',
+        'img', 'kbd', 'li', 'listing', 'map', 'menu', 'ol', 'p', 'pre', 'q',
+        's', 'samp', 'small', 'span', 'strike', 'strong', 'sub', 'sup',
+        'table', 'tt', 'u', 'ul', 'var', 'xmp'] ],
+    [ 'hr', ['form'] ],
+    [ 'i', ['center', 'p', 'td', 'th'] ],
+    [ 'legend', ['fieldset'] ],
+    [ 'li', ['li'] ],
+    [ 'link', ['body', 'frameset'] ],
+    [ 'listing', ['dd', 'dl', 'dt', 'fieldset', 'form', 'li', 'table', 'ul'] ],
+    [ 'menu', ['dd', 'dl', 'dt', 'form', 'ul'] ],
+    [ 'ol', ['form'] ],
+    [ 'option', ['optgroup', 'option'] ],
+    [ 'p', ['address', 'blockquote', 'body', 'caption', 'center', 'col',
+        'colgroup', 'dd', 'dir', 'div', 'dl', 'dt', 'fieldset', 'form',
+        'frameset', 'h1', 'h2', 'h3', 'h4', 'h5', 'h6', 'head', 'hr', 'li',
+        'listing', 'menu', 'ol', 'p', 'pre', 'table', 'tbody', 'td',
+        'tfoot', 'th', 'title', 'tr', 'ul', 'xmp'] ],
+    [ 'pre', ['dd', 'dl', 'dt', 'fieldset', 'form', 'li', 'table', 'ul'] ],
+    [ 's', ['p'] ],
+    [ 'script', ['noscript'] ],
+    [ 'small', ['p'] ],
+    [ 'span', ['td', 'th'] ],
+    [ 'strike', ['p'] ],
+    [ 'style', ['body', 'frameset'] ],
+    [ 'tbody', ['tbody', 'tfoot'] ],
+    [ 'td', ['tbody', 'td', 'tfoot', 'th', 'tr'] ],
+    [ 'tfoot', ['tbody'] ],
+    [ 'th', ['tbody', 'td', 'tfoot', 'th', 'tr'] ],
+    [ 'thead', ['tbody', 'tfoot'] ],
+    [ 'title', ['body', 'frameset'] ],
+    [ 'tr', ['tbody', 'tfoot', 'tr'] ],
+    [ 'tt', ['p'] ],
+    [ 'u', ['p', 'td', 'th'] ],
+    [ 'ul', ['address', 'form', 'menu', 'pre'] ],
+    [ 'xmp', ['dd', 'dl', 'dt', 'fieldset', 'form', 'li', 'table', 'ul'] ],
+]
+
+FNV_PRIME = 0x01000193
+
+def tag_hash(seed, name):
+    h = seed
+    for c in name.lower():
+        h = ((h ^ ord(c)) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+def find_seed(names):
+    bits = 7
+    while True:
+        for seed in range(1, 100000):
+            slots = set(tag_hash(seed, n) >> (32 - bits) for n in names)
+            if len(slots) == len(names):
+                return seed, bits
+        bits += 1
+
+with open('HTMLparser.c') as f:
+    src = f.read()
+start = src.index('html40ElementTable[] = {')
+end = src.index('\n};', start)
+elems = re.findall(r'^\{ "([^"]+)",', src[start:end], re.M)
+
+tags = list(elems)
+for old, news in start_close:
+    for name in [ old ] + news:
+        if name not in tags:
+            tags.append(name)
+index = { name: i for i, name in enumerate(tags) }
+
+seed, bits = find_seed(tags)
+hash_tab = [ 0 ] * (1 << bits)
+for i, name in enumerate(tags):
+    hash_tab[tag_hash(seed, name) >> (32 - bits)] = i + 1
+
+row_size = (len(tags) + 7) // 8
+matrix = [ [ 0 ] * row_size for _ in tags ]
+for old, news in start_close:
+    row = matrix[index[old]]
+    for name in news:
+        row[index[name] // 8] |= 1 << (index[name] % 8)
+
+def c_array(values, width, per_line):
+    r = ''
+    for i, v in enumerate(values):
+        if i % per_line == 0: r += '\n    '
+        else: r += ' '
+        r += '%*d,' % (width, v)
+    return r[:-1]
+
+with open('codegen/htmlelem.inc', 'w') as out:
+    out.write('#define HTML_ELEM_COUNT %d\n' % len(elems))
+    out.write('#define HTML_TAG_COUNT %d\n' % len(tags))
+    out.write('#define HTML_TAG_MAX_LEN %d\n' % max(len(n) for n in tags))
+    out.write('#define HTML_TAG_HASH_SEED 0x%08Xu\n' % seed)
+    out.write('#define HTML_TAG_HASH_BITS %d\n\n' % bits)
+
+    out.write('enum {\n')
+    for i, name in enumerate(tags):
+        out.write('    HTML_TAG_%s = %d%s\n' %
+                  (name.upper(), i, ',' if i < len(tags) - 1 else ''))
+    out.write('};\n\n')
+
+    out.write('static const unsigned char htmlTagHashTab[%d] = {%s\n};\n\n' %
+              (len(hash_tab), c_array(hash_tab, 3, 12)))
+
+    r = ''
+    for i, name in enumerate(tags):
+        if i % 6 == 0: r += '\n    '
+        else: r += ' '
+        r += '"%s",' % name
+    out.write('static const char *const htmlTagNames[%d] = {%s\n};\n\n' %
+              (len(tags), r[:-1]))
+
+    out.write('static const unsigned char htmlStartCloseTab[%d][%d] = {\n' %
+              (len(tags), row_size))
+    for i, row in enumerate(matrix):
+        out.write('    /* %s */\n' % tags[i])
+        out.write('    { %s }%s\n' %
+                  (','.join('0x%02X' % b for b in row),
+                   ',' if i < len(tags) - 1 else ''))
+    out.write('};\n')
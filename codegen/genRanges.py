@@ -220,3 +220,102 @@ for f in fkeys:
 
 output.close()
 
+
+#
+# Finally the name character classes used by the parser. For each
+# class, a bitmap of the BMP is split into pages of 256 code points.
+# Identical pages are shared, so a lookup is one load from the page
+# index and one from the bitset. Code points above 0xFFFF are handled
+# by the parser.
+#
+
+def inClass(f, ch):
+    if ch < 0x100:
+        return Functs[f][0][ch] == 1
+    for (low, high) in Functs[f][1]:
+        if low <= ch <= high:
+            return True
+    return False
+
+# [4] NameStartChar of XML 1.0 fifth edition
+nameStart5 = [ (ord('a'), ord('z')), (ord('A'), ord('Z')),
+               (ord('_'), ord('_')), (ord(':'), ord(':')),
+               (0xC0, 0xD6), (0xD8, 0xF6), (0xF8, 0x2FF), (0x370, 0x37D),
+               (0x37F, 0x1FFF), (0x200C, 0x200D), (0x2070, 0x218F),
+               (0x2C00, 0x2FEF), (0x3001, 0xD7FF), (0xF900, 0xFDCF),
+               (0xFDF0, 0xFFFD) ]
+# [4a] NameChar of XML 1.0 fifth edition
+nameChar5 = nameStart5 + [ (ord('0'), ord('9')), (ord('-'), ord('.')),
+                           (0xB7, 0xB7), (0x300, 0x36F), (0x203F, 0x2040) ]
+
+def inRanges(ranges, ch):
+    for (low, high) in ranges:
+        if low <= ch <= high:
+            return True
+    return False
+
+def isLetter(ch):
+    return inClass('xmlIsBaseChar', ch) or inClass('xmlIsIdeographic', ch)
+
+nameClasses = [
+    ('XML_NAME_START', lambda ch: inRanges(nameStart5, ch)),
+    ('XML_NAME_CHAR', lambda ch: inRanges(nameChar5, ch)),
+    ('XML_NAME_START_OLD10', lambda ch:
+        isLetter(ch) or ch in (ord('_'), ord(':'))),
+    ('XML_NAME_CHAR_OLD10', lambda ch:
+        isLetter(ch) or inClass('xmlIsDigit', ch) or
+        inClass('xmlIsCombining', ch) or inClass('xmlIsExtender', ch) or
+        ch in (ord('.'), ord('-'), ord('_'), ord(':'))),
+]
+
+blocks = []
+blockIndex = {}
+pageTab = []
+for page in range(256):
+    block = []
+    for (cname, test) in nameClasses:
+        for byte in range(32):
+            v = 0
+            for bit in range(8):
+                if test(page * 256 + byte * 8 + bit):
+                    v |= 1 << bit
+            block.append(v)
+    block = tuple(block)
+    if block not in blockIndex:
+        blockIndex[block] = len(blocks)
+        blocks.append(block)
+    pageTab.append(blockIndex[block])
+
+try:
+    output = open("codegen/names.inc", "w")
+except:
+    print("Failed to open codegen/names.inc")
+    sys.exit(1)
+
+for i, (cname, test) in enumerate(nameClasses):
+    output.write("#define %s %d\n" % (cname, i))
+output.write("\n")
+
+output.write("static const unsigned char xmlNamePageTab[256] = {")
+for i, v in enumerate(pageTab):
+    if i % 12 == 0:
+        output.write("\n   ")
+    output.write(" %3d," % v if i < 255 else " %3d" % v)
+output.write(" };\n\n")
+
+output.write("static const unsigned char xmlNameBitsTab[%d][%d][32] = {\n" %
+             (len(blocks), len(nameClasses)))
+for i, block in enumerate(blocks):
+    output.write("  {\n")
+    for c in range(len(nameClasses)):
+        row = block[c * 32:(c + 1) * 32]
+        output.write("    {")
+        for j in range(32):
+            if j % 11 == 0:
+                output.write("\n     ")
+            output.write(" 0x%02x%s" % (row[j], "," if j < 31 else ""))
+        output.write(" }%s\n" % ("," if c < len(nameClasses) - 1 else ""))
+    output.write("  }%s\n" % ("," if i < len(blocks) - 1 else ""))
+output.write("};\n")
+
+output.close()
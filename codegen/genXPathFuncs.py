@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+
+import re
+
+# Hash table for the XPath core function library.
+#
+# xmlXPathSFHash maps a slot to the index of the function in
+# xmlXPathStandardFunctions in xpath.c, which is read to get the
+# function names, or 0xFF if the slot is empty. Collisions are
+# resolved with linear probing. The hash is DJB2, see
+# xmlXPathSFComputeHash.
+
+hash_size = 64
+
+src = open('xpath.c').read()
+m = re.search(r'xmlXPathStandardFunctions\[\] = \{(.*?)\n\};', src, re.S)
+names = re.findall(r'\{ "([^"]+)", \w+ \}', m.group(1))
+
+assert len(names) < 0xFF
+
+def djb2(name):
+    h = 5381
+    for c in name.encode():
+        h = (h * 33 + c) & 0xFFFFFFFF
+    return h
+
+table = [ 0xFF ] * hash_size
+
+for i, name in enumerate(names):
+    slot = djb2(name) % hash_size
+    while table[slot] != 0xFF:
+        slot = (slot + 1) % hash_size
+    table[slot] = i
+
+out = open('codegen/xpathfuncs.inc', 'w')
+
+out.write('''/*
+ * XPath core function hash table.
+ *
+ * Generated with codegen/genXPathFuncs.py.
+ */
+
+''')
+
+out.write(f'#define SF_HASH_SIZE {hash_size}\n\n')
+out.write('static const unsigned char xmlXPathSFHash[SF_HASH_SIZE] = {\n')
+for i in range(0, hash_size, 8):
+    out.write('    ' + ' '.join(f'0x{v:02x},' for v in table[i:i+8]) + '\n')
+out.write('};\n')
+
+out.close()
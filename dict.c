@@ -56,6 +56,27 @@ struct _xmlDictStrings {
 
 typedef xmlHashedString xmlDictEntry;
 
+/*
+ * Namespace URI ID of a string in the dictionary, see xmlDictNsId
+ */
+typedef struct {
+    const xmlChar *name;
+    unsigned hashValue;
+    int id;
+} xmlDictNsEntry;
+
+#define XML_DICT_NS_MAX_SIZE (1u << 20)
+
+/*
+ * Number of shards of a concurrent dictionary, must be a power of two
+ */
+#define XML_DICT_SHARDS 64
+
+typedef struct {
+    xmlMutex mutex;
+    struct _xmlDict *dict;
+} xmlDictShard;
+
 /*
  * The entire dictionary
  */
@@ -72,14 +93,43 @@ struct _xmlDict {
     unsigned seed;
     /* used to impose a limit on size */
     size_t limit;
+    /* read-only, see xmlDictFreeze */
+    int frozen;
+    /* independently locked parts of a concurrent dictionary */
+    xmlDictShard *shards;
+    /* dictionary whose strings are viewed, see xmlDictNewView */
+    struct _xmlDict *viewOf;
+    /* number of lookups which may insert, for parser statistics */
+    unsigned long lookups;
+    /* namespace URI IDs, see xmlDictNsId */
+    xmlDictNsEntry *nsTable;
+    unsigned nsSize;
+    unsigned nsElems;
+    int nsNextId;
+    int nsEndId;
 };
 
+/*
+ * Get the shard of a concurrent dictionary responsible for a hash value.
+ * The lower bits are used to index the shard's hash table.
+ */
+static xmlDictShard *
+xmlDictGetShard(xmlDictPtr dict, unsigned hashValue) {
+    return(&dict->shards[(hashValue >> 24) & (XML_DICT_SHARDS - 1)]);
+}
+
 /*
  * A mutex for modifying the reference counter for shared
  * dictionaries.
  */
 static xmlMutex xmlDictMutex;
 
+/*
+ * Number of the last block of namespace URI IDs handed out to a
+ * dictionary. Protected by xmlDictMutex.
+ */
+static int xmlDictNsBlocks;
+
 /**
  * @deprecated Alias for #xmlInitParser.
  *
@@ -266,6 +316,14 @@ xmlDictCreate(void) {
     dict->table = NULL;
     dict->strings = NULL;
     dict->subdict = NULL;
+    dict->frozen = 0;
+    dict->shards = NULL;
+    dict->viewOf = NULL;
+    dict->nsTable = NULL;
+    dict->nsSize = 0;
+    dict->nsElems = 0;
+    dict->nsNextId = 0;
+    dict->nsEndId = 0;
     dict->seed = xmlRandom();
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
     dict->seed = 0;
@@ -279,6 +337,9 @@ xmlDictCreate(void) {
  * new dictionary, then in `sub`, and if not found are created in the
  * new dictionary.
  *
+ * If `sub` was frozen with #xmlDictFreeze, dictionaries created
+ * from it can be used in different threads concurrently.
+ *
  * @param sub  an existing dictionary
  * @returns the newly created dictionary, or NULL if an error occurred.
  */
@@ -294,6 +355,105 @@ xmlDictCreateSub(xmlDict *sub) {
     return(dict);
 }
 
+/**
+ * Create a new dictionary which can be used from multiple threads
+ * at the same time. Typically, a concurrent dictionary is shared
+ * between parser contexts running in different threads, so that
+ * the resulting documents share the same strings.
+ *
+ * The dictionary is split into shards which are locked
+ * independently. This adds locking overhead to every operation,
+ * so concurrent dictionaries should only be used if they're
+ * actually shared.
+ *
+ * @since 2.16.0
+ *
+ * @returns the newly created dictionary, or NULL if a memory
+ * allocation failed.
+ */
+xmlDict *
+xmlDictCreateConcurrent(void) {
+    xmlDictPtr dict;
+    int i;
+
+    dict = xmlDictCreate();
+    if (dict == NULL)
+        return(NULL);
+
+    dict->shards = xmlMalloc(XML_DICT_SHARDS * sizeof(dict->shards[0]));
+    if (dict->shards == NULL) {
+        xmlFree(dict);
+        return(NULL);
+    }
+
+    for (i = 0; i < XML_DICT_SHARDS; i++) {
+        xmlDictPtr shard = xmlDictCreate();
+
+        if (shard == NULL) {
+            while (--i >= 0) {
+                xmlCleanupMutex(&dict->shards[i].mutex);
+                xmlDictFree(dict->shards[i].dict);
+            }
+            xmlFree(dict->shards);
+            xmlFree(dict);
+            return(NULL);
+        }
+
+        /* Hash values must match the parent */
+        shard->seed = dict->seed;
+        dict->shards[i].dict = shard;
+        xmlInitMutex(&dict->shards[i].mutex);
+    }
+
+    return(dict);
+}
+
+/**
+ * Create a read-only view of the strings stored in `dict` at the
+ * time of the call. The view only supports #xmlDictOwns and
+ * #xmlDictFree. It keeps a reference to `dict`.
+ *
+ * Unlike `dict`, the view can be used to check the ownership of
+ * these strings from another thread while `dict` is still used to
+ * add new strings. String pools are only ever prepended and their
+ * bounds never change, so the pools visible when the view is
+ * created stay valid.
+ *
+ * @param dict  the dictionary
+ * @returns the view or NULL if a memory allocation failed.
+ */
+xmlDictPtr
+xmlDictNewView(xmlDictPtr dict) {
+    xmlDictPtr view;
+
+    if (dict == NULL)
+        return(NULL);
+
+    view = xmlMalloc(sizeof(*view));
+    if (view == NULL)
+        return(NULL);
+    memset(view, 0, sizeof(*view));
+    view->ref_counter = 1;
+    view->strings = dict->strings;
+    view->seed = dict->seed;
+    /* Shards are locked and can be shared */
+    view->shards = dict->shards;
+    view->frozen = 1;
+
+    if (dict->subdict != NULL) {
+        view->subdict = xmlDictNewView(dict->subdict);
+        if (view->subdict == NULL) {
+            xmlFree(view);
+            return(NULL);
+        }
+    }
+
+    xmlDictReference(dict);
+    view->viewOf = dict;
+
+    return(view);
+}
+
 /**
  * Increment the reference counter of a dictionary
  *
@@ -309,6 +469,69 @@ xmlDictReference(xmlDict *dict) {
     return(0);
 }
 
+/**
+ * Check whether a dictionary is referenced more than once.
+ *
+ * @param dict  the dictionary
+ * @returns 1 if the dictionary is shared, 0 otherwise.
+ */
+int
+xmlDictIsShared(xmlDict *dict) {
+    int ret;
+
+    if (dict == NULL)
+        return(0);
+    xmlMutexLock(&xmlDictMutex);
+    ret = (dict->ref_counter > 1);
+    xmlMutexUnlock(&xmlDictMutex);
+    return(ret);
+}
+
+/**
+ * Check whether a dictionary was created with
+ * #xmlDictCreateConcurrent.
+ *
+ * @param dict  the dictionary
+ * @returns 1 if the dictionary is concurrent, 0 otherwise.
+ */
+int
+xmlDictIsConcurrent(xmlDict *dict) {
+    return((dict != NULL) && (dict->shards != NULL));
+}
+
+/**
+ * Make a dictionary read-only. Strings can't be added to a frozen
+ * dictionary anymore. Lookups of new strings with #xmlDictLookup or
+ * #xmlDictQLookup fail and return NULL.
+ *
+ * Since lookups don't modify a frozen dictionary, it can be shared
+ * between threads without locking, typically as sub-dictionary of
+ * per-thread dictionaries created with #xmlDictCreateSub. Fill the
+ * dictionary with frequently used names first. The dictionary must
+ * be handed to other threads only after it was frozen.
+ *
+ * @since 2.16.0
+ *
+ * @param dict  the dictionary
+ * @returns 0 on success or -1 if `dict` is NULL.
+ */
+int
+xmlDictFreeze(xmlDict *dict) {
+    if (dict == NULL)
+        return(-1);
+    if (dict->shards != NULL) {
+        int i;
+
+        for (i = 0; i < XML_DICT_SHARDS; i++) {
+            xmlMutexLock(&dict->shards[i].mutex);
+            dict->shards[i].dict->frozen = 1;
+            xmlMutexUnlock(&dict->shards[i].mutex);
+        }
+    }
+    dict->frozen = 1;
+    return(0);
+}
+
 /**
  * Free the hash `dict` and its contents. The userdata is
  * deallocated with `f` if provided.
@@ -332,13 +555,31 @@ xmlDictFree(xmlDict *dict) {
 
     xmlMutexUnlock(&xmlDictMutex);
 
+    if (dict->viewOf != NULL) {
+        xmlDictFree(dict->subdict);
+        xmlDictFree(dict->viewOf);
+        xmlFree(dict);
+        return;
+    }
+
     if (dict->subdict != NULL) {
         xmlDictFree(dict->subdict);
     }
 
+    if (dict->shards != NULL) {
+        int i;
+
+        for (i = 0; i < XML_DICT_SHARDS; i++) {
+            xmlCleanupMutex(&dict->shards[i].mutex);
+            xmlDictFree(dict->shards[i].dict);
+        }
+        xmlFree(dict->shards);
+    }
+
     if (dict->table) {
 	xmlFree(dict->table);
     }
+    xmlFree(dict->nsTable);
     pool = dict->strings;
     while (pool != NULL) {
         nextp = pool->next;
@@ -362,9 +603,27 @@ xmlDictOwns(xmlDict *dict, const xmlChar *str) {
 
     if ((dict == NULL) || (str == NULL))
 	return(-1);
+    if (dict->shards != NULL) {
+        xmlDictShard *shard;
+        int ret;
+
+        /*
+         * A string can only be stored in the shard selected by its
+         * hash value. QNames hash like strings containing a colon.
+         */
+        shard = xmlDictGetShard(dict, xmlDictComputeHash(dict, str));
+        xmlMutexLock(&shard->mutex);
+        ret = xmlDictOwns(shard->dict, str);
+        xmlMutexUnlock(&shard->mutex);
+        if (ret == 1)
+            return(1);
+    }
     pool = dict->strings;
     while (pool != NULL) {
-        if ((str >= &pool->array[0]) && (str <= pool->free))
+        if ((str >= &pool->array[0]) &&
+            ((dict->viewOf != NULL) ?
+             (str < pool->end) :
+             (str <= pool->free)))
 	    return(1);
 	pool = pool->next;
     }
@@ -382,11 +641,47 @@ xmlDictOwns(xmlDict *dict, const xmlChar *str) {
  */
 int
 xmlDictSize(xmlDict *dict) {
+    int ret;
+
     if (dict == NULL)
 	return(-1);
+    ret = dict->nbElems;
+    if (dict->shards != NULL) {
+        int i;
+
+        for (i = 0; i < XML_DICT_SHARDS; i++) {
+            xmlMutexLock(&dict->shards[i].mutex);
+            ret += dict->shards[i].dict->nbElems;
+            xmlMutexUnlock(&dict->shards[i].mutex);
+        }
+    }
     if (dict->subdict)
-        return(dict->nbElems + dict->subdict->nbElems);
-    return(dict->nbElems);
+        ret += xmlDictSize(dict->subdict);
+    return(ret);
+}
+
+/**
+ * @param dict  the dictionary
+ * @returns the number of lookups which would have added a missing
+ * string, including those of concurrent shards.
+ */
+unsigned long
+xmlDictGetLookups(xmlDict *dict) {
+    unsigned long ret;
+
+    if (dict == NULL)
+        return(0);
+    ret = dict->lookups;
+    if (dict->shards != NULL) {
+        int i;
+
+        for (i = 0; i < XML_DICT_SHARDS; i++) {
+            xmlMutexLock(&dict->shards[i].mutex);
+            ret += dict->shards[i].dict->lookups;
+            xmlMutexUnlock(&dict->shards[i].mutex);
+        }
+    }
+    return(ret);
 }
 
 /**
@@ -403,6 +698,18 @@ xmlDictSetLimit(xmlDict *dict, size_t limit) {
 
     if (dict == NULL)
 	return(0);
+    if (dict->shards != NULL) {
+        int i;
+
+        /* The limit of the parent isn't used */
+        for (i = 0; i < XML_DICT_SHARDS; i++) {
+            xmlMutexLock(&dict->shards[i].mutex);
+            ret = dict->shards[i].dict->limit;
+            dict->shards[i].dict->limit = limit;
+            xmlMutexUnlock(&dict->shards[i].mutex);
+        }
+        return(ret);
+    }
     ret = dict->limit;
     dict->limit = limit;
     return(ret);
@@ -422,6 +729,15 @@ xmlDictGetUsage(xmlDict *dict) {
 
     if (dict == NULL)
 	return(0);
+    if (dict->shards != NULL) {
+        int i;
+
+        for (i = 0; i < XML_DICT_SHARDS; i++) {
+            xmlMutexLock(&dict->shards[i].mutex);
+            limit += xmlDictGetUsage(dict->shards[i].dict);
+            xmlMutexUnlock(&dict->shards[i].mutex);
+        }
+    }
     pool = dict->strings;
     while (pool != NULL) {
         limit += pool->size;
@@ -441,49 +757,30 @@ ATTRIBUTE_NO_SANITIZE_INTEGER
 static unsigned
 xmlDictHashName(unsigned seed, const xmlChar* data, size_t maxLen,
                 size_t *plen) {
-    unsigned h1, h2;
-    size_t i;
-
-    HASH_INIT(h1, h2, seed);
+    xmlHashState st;
 
-    for (i = 0; i < maxLen && data[i]; i++) {
-        HASH_UPDATE(h1, h2, data[i]);
-    }
+    xmlHashInit(&st, seed);
+    *plen = xmlHashUpdateString(&st, data, maxLen);
 
-    HASH_FINISH(h1, h2);
-
-    *plen = i;
-    return(h2 | MAX_HASH_SIZE);
+    return(xmlHashFinish(&st) | MAX_HASH_SIZE);
 }
 
 ATTRIBUTE_NO_SANITIZE_INTEGER
 static unsigned
 xmlDictHashQName(unsigned seed, const xmlChar *prefix, const xmlChar *name,
                  size_t *pplen, size_t *plen) {
-    unsigned h1, h2;
-    size_t i;
+    xmlHashState st;
 
-    HASH_INIT(h1, h2, seed);
-
-    for (i = 0; prefix[i] != 0; i++) {
-        HASH_UPDATE(h1, h2, prefix[i]);
-    }
-    *pplen = i;
-
-    HASH_UPDATE(h1, h2, ':');
-
-    for (i = 0; name[i] != 0; i++) {
-        HASH_UPDATE(h1, h2, name[i]);
-    }
-    *plen = i;
-
-    HASH_FINISH(h1, h2);
+    xmlHashInit(&st, seed);
+    *pplen = xmlHashUpdateString(&st, prefix, SIZE_MAX);
+    xmlHashUpdateByte(&st, ':');
+    *plen = xmlHashUpdateString(&st, name, SIZE_MAX);
 
     /*
      * Always set the upper bit of hash values since 0 means an unoccupied
      * bucket.
      */
-    return(h2 | MAX_HASH_SIZE);
+    return(xmlHashFinish(&st) | MAX_HASH_SIZE);
 }
 
 /**
@@ -652,6 +949,75 @@ done:
     return(0);
 }
 
+/**
+ * Grow the table of a dictionary so that it holds `size` strings
+ * without further resizing.
+ *
+ * @param dict  dictionary
+ * @param size  number of strings
+ * @returns 0 in case of success, -1 if a memory allocation failed
+ * or the size is too large.
+ */
+static int
+xmlDictReserveInternal(xmlDictPtr dict, unsigned size) {
+    unsigned tableSize = MIN_HASH_SIZE;
+
+    if (size > MAX_HASH_SIZE / MAX_FILL_DENOM * MAX_FILL_NUM)
+        return(-1);
+    while (size > tableSize / MAX_FILL_DENOM * MAX_FILL_NUM)
+        tableSize *= 2;
+    if (tableSize <= dict->size)
+        return(0);
+
+    return(xmlDictGrow(dict, tableSize));
+}
+
+/**
+ * Make room for `size` strings in a dictionary, so that adding that
+ * many strings doesn't resize its hash table repeatedly. This is
+ * useful before filling a dictionary with a known number of names.
+ * The strings themselves are still allocated as they are added.
+ *
+ * Concurrent dictionaries spread the room over their shards.
+ * Frozen dictionaries and views can't be resized.
+ *
+ * @since 2.16.0
+ *
+ * @param dict  the dictionary
+ * @param size  the total number of strings
+ * @returns 0 in case of success, -1 if the arguments are invalid,
+ * the dictionary is frozen or a memory allocation failed.
+ */
+int
+xmlDictReserve(xmlDict *dict, int size) {
+    int ret = 0;
+
+    if ((dict == NULL) || (size < 0) || (dict->frozen))
+        return(-1);
+
+    if (dict->shards != NULL) {
+        unsigned perShard;
+        int i;
+
+        /* Leave some room for uneven distribution */
+        perShard = (unsigned) size / XML_DICT_SHARDS;
+        perShard += perShard / 4 + 1;
+
+        for (i = 0; i < XML_DICT_SHARDS; i++) {
+            xmlMutexLock(&dict->shards[i].mutex);
+            if ((dict->shards[i].dict->frozen) ||
+                (xmlDictReserveInternal(dict->shards[i].dict,
+                                        perShard) != 0))
+                ret = -1;
+            xmlMutexUnlock(&dict->shards[i].mutex);
+        }
+
+        return(ret);
+    }
+
+    return(xmlDictReserveInternal(dict, size));
+}
+
 /**
  * Internal lookup and update function.
  *
@@ -660,11 +1026,13 @@ done:
  * @param name  string
  * @param maybeLen  length of string or -1 if unknown
  * @param update  whether the string should be added
+ * @param knownHash  hash value of a name with known length or 0
  */
 ATTRIBUTE_NO_SANITIZE_INTEGER
 static const xmlDictEntry *
 xmlDictLookupInternal(xmlDict *dict, const xmlChar *prefix,
-                      const xmlChar *name, int maybeLen, int update) {
+                      const xmlChar *name, int maybeLen, int update,
+                      unsigned knownHash) {
     xmlDictEntry *entry = NULL;
     const xmlChar *ret;
     unsigned hashValue, newSize;
@@ -676,7 +1044,13 @@ xmlDictLookupInternal(xmlDict *dict, const xmlChar *prefix,
 
     maxLen = (maybeLen < 0) ? SIZE_MAX : (size_t) maybeLen;
 
-    if (prefix == NULL) {
+    if (knownHash != 0) {
+        hashValue = knownHash;
+        len = maxLen;
+        if (len > INT_MAX / 2)
+            return(NULL);
+        klen = len;
+    } else if (prefix == NULL) {
         hashValue = xmlDictHashName(dict->seed, name, maxLen, &len);
         if (len > INT_MAX / 2)
             return(NULL);
@@ -691,6 +1065,9 @@ xmlDictLookupInternal(xmlDict *dict, const xmlChar *prefix,
     if ((dict->limit > 0) && (klen >= dict->limit))
         return(NULL);
 
+    if (update)
+        dict->lookups++;
+
     /*
      * Check for an existing entry
      */
@@ -714,7 +1091,9 @@ xmlDictLookupInternal(xmlDict *dict, const xmlChar *prefix,
         xmlDictEntry *subEntry;
         unsigned subHashValue;
 
-        if (prefix == NULL)
+        if ((knownHash != 0) && (dict->subdict->seed == dict->seed))
+            subHashValue = knownHash;
+        else if (prefix == NULL)
             subHashValue = xmlDictHashName(dict->subdict->seed, name, len,
                                            &len);
         else
@@ -726,7 +1105,7 @@ xmlDictLookupInternal(xmlDict *dict, const xmlChar *prefix,
             return(subEntry);
     }
 
-    if (!update)
+    if ((!update) || (dict->frozen))
         return(NULL);
 
     /*
@@ -801,6 +1180,84 @@ xmlDictLookupInternal(xmlDict *dict, const xmlChar *prefix,
     return(entry);
 }
 
+/**
+ * Lookup a string in a dictionary, handling concurrent dictionaries.
+ * The result must be copied because entries of concurrent
+ * dictionaries can move once the shard is unlocked.
+ *
+ * @param dict  dictionary
+ * @param prefix  optional QName prefix
+ * @param name  string
+ * @param maybeLen  length of string or -1 if unknown
+ * @param update  whether the string should be added
+ * @param knownHash  hash value of a name with known length or 0
+ * @returns the hashed string. The name is NULL if the string
+ * wasn't found or couldn't be added.
+ */
+static xmlHashedString
+xmlDictLookupSafe(xmlDict *dict, const xmlChar *prefix,
+                  const xmlChar *name, int maybeLen, int update,
+                  unsigned knownHash) {
+    const xmlDictEntry *entry;
+    xmlHashedString ret;
+
+    ret.name = NULL;
+    ret.hashValue = 0;
+
+    if ((dict == NULL) || (name == NULL))
+        return(ret);
+
+    if (dict->shards != NULL) {
+        xmlDictShard *shard;
+        unsigned hashValue;
+        size_t len, plen;
+
+        if (knownHash != 0)
+            hashValue = knownHash;
+        else if (prefix == NULL)
+            hashValue = xmlDictHashName(dict->seed, name,
+                                        (maybeLen < 0) ? SIZE_MAX :
+                                                         (size_t) maybeLen,
+                                        &len);
+        else
+            hashValue = xmlDictHashQName(dict->seed, prefix, name,
+                                         &plen, &len);
+
+        shard = xmlDictGetShard(dict, hashValue);
+        xmlMutexLock(&shard->mutex);
+        entry = xmlDictLookupInternal(shard->dict, prefix, name, maybeLen,
+                                      update, knownHash);
+        if (entry != NULL)
+            ret = *entry;
+        xmlMutexUnlock(&shard->mutex);
+
+        return(ret);
+    }
+
+    if ((dict->subdict != NULL) && (dict->subdict->shards != NULL)) {
+        /*
+         * Concurrent sub-dictionary, xmlDictLookupInternal can't
+         * use it.
+         */
+        entry = xmlDictLookupInternal(dict, prefix, name, maybeLen, 0,
+                                      knownHash);
+        if (entry != NULL)
+            return(*entry);
+        ret = xmlDictLookupSafe(dict->subdict, prefix, name, maybeLen, 0,
+                                (dict->subdict->seed == dict->seed) ?
+                                knownHash : 0);
+        if ((ret.name != NULL) || (!update))
+            return(ret);
+    }
+
+    entry = xmlDictLookupInternal(dict, prefix, name, maybeLen, update,
+                                  knownHash);
+    if (entry != NULL)
+        ret = *entry;
+
+    return(ret);
+}
+
 /**
  * Lookup a string and add it to the dictionary if it wasn't found.
  *
@@ -812,12 +1269,7 @@ xmlDictLookupInternal(xmlDict *dict, const xmlChar *prefix,
  */
 const xmlChar *
 xmlDictLookup(xmlDict *dict, const xmlChar *name, int len) {
-    const xmlDictEntry *entry;
-
-    entry = xmlDictLookupInternal(dict, NULL, name, len, 1);
-    if (entry == NULL)
-        return(NULL);
-    return(entry->name);
+    return(xmlDictLookupSafe(dict, NULL, name, len, 1, 0).name);
 }
 
 /**
@@ -831,19 +1283,40 @@ xmlDictLookup(xmlDict *dict, const xmlChar *name, int len) {
  */
 xmlHashedString
 xmlDictLookupHashed(xmlDict *dict, const xmlChar *name, int len) {
-    const xmlDictEntry *entry;
-    xmlHashedString ret;
-
-    entry = xmlDictLookupInternal(dict, NULL, name, len, 1);
+    return(xmlDictLookupSafe(dict, NULL, name, len, 1, 0));
+}
 
-    if (entry == NULL) {
-        ret.name = NULL;
-        ret.hashValue = 0;
-    } else {
-        ret = *entry;
-    }
+/**
+ * Start computing the hash value of a name for
+ * #xmlDictLookupHashedName.
+ *
+ * @param dict  dictionary
+ * @param st  hash state to initialize
+ */
+void
+xmlDictHashStart(const xmlDict *dict, xmlHashState *st) {
+    xmlHashInit(st, (dict != NULL) ? dict->seed : 0);
+}
 
-    return(ret);
+/**
+ * Like #xmlDictLookupHashed, but with a hash value computed while
+ * scanning the name. `hashValue` is the result of #xmlHashFinish
+ * for a state started with #xmlDictHashStart and updated with the
+ * `len` bytes of `name`, which must not contain NUL bytes.
+ *
+ * @param dict  dictionary
+ * @param name  string key
+ * @param len  length of the key
+ * @param hashValue  hash value of the key
+ * @returns the dictionary entry.
+ */
+xmlHashedString
+xmlDictLookupHashedName(xmlDict *dict, const xmlChar *name, int len,
+                        unsigned hashValue) {
+    if (len < 0)
+        return(xmlDictLookupSafe(dict, NULL, name, len, 1, 0));
+    return(xmlDictLookupSafe(dict, NULL, name, len, 1,
+                             hashValue | MAX_HASH_SIZE));
 }
 
 /**
@@ -856,12 +1329,7 @@ xmlDictLookupHashed(xmlDict *dict, const xmlChar *name, int len) {
  */
 const xmlChar *
 xmlDictExists(xmlDict *dict, const xmlChar *name, int len) {
-    const xmlDictEntry *entry;
-
-    entry = xmlDictLookupInternal(dict, NULL, name, len, 0);
-    if (entry == NULL)
-        return(NULL);
-    return(entry->name);
+    return(xmlDictLookupSafe(dict, NULL, name, len, 0, 0).name);
 }
 
 /**
@@ -876,12 +1344,331 @@ xmlDictExists(xmlDict *dict, const xmlChar *name, int len) {
  */
 const xmlChar *
 xmlDictQLookup(xmlDict *dict, const xmlChar *prefix, const xmlChar *name) {
-    const xmlDictEntry *entry;
+    return(xmlDictLookupSafe(dict, prefix, name, -1, 1, 0).name);
+}
+
+static int
+xmlDictNsGrow(xmlDictPtr dict) {
+    xmlDictNsEntry *table;
+    unsigned newSize, mask, i, j;
+
+    newSize = (dict->nsSize > 0) ? dict->nsSize * 2 : 16;
+    if (newSize > XML_DICT_NS_MAX_SIZE)
+        return(-1);
+    table = xmlMalloc(newSize * sizeof(table[0]));
+    if (table == NULL)
+        return(-1);
+    memset(table, 0, newSize * sizeof(table[0]));
+
+    mask = newSize - 1;
+    for (i = 0; i < dict->nsSize; i++) {
+        const xmlDictNsEntry *entry = &dict->nsTable[i];
+
+        if (entry->name == NULL)
+            continue;
+        for (j = entry->hashValue & mask; table[j].name != NULL;
+             j = (j + 1) & mask)
+            ;
+        table[j] = *entry;
+    }
+
+    xmlFree(dict->nsTable);
+    dict->nsTable = table;
+    dict->nsSize = newSize;
+    return(0);
+}
+
+static int
+xmlDictNsIdInternal(xmlDictPtr dict, const xmlChar *href, int update) {
+    xmlHashedString hstr;
+    xmlDictNsEntry *entry;
+    unsigned mask, i;
+
+    if (dict->frozen)
+        update = 0;
+
+    hstr = xmlDictLookupSafe(dict, NULL, href, -1, update, 0);
+    if (hstr.name == NULL)
+        return(0);
+
+    if (dict->nsSize > 0) {
+        mask = dict->nsSize - 1;
+        for (i = hstr.hashValue & mask; dict->nsTable[i].name != NULL;
+             i = (i + 1) & mask) {
+            if (dict->nsTable[i].name == hstr.name)
+                return(dict->nsTable[i].id);
+        }
+    }
+    if (!update)
+        return(0);
+
+    if (dict->nsNextId == dict->nsEndId) {
+        int block = 0;
+
+        xmlMutexLock(&xmlDictMutex);
+        if (xmlDictNsBlocks < INT_MAX / XML_DICT_NS_ID_BLOCK - 1)
+            block = ++xmlDictNsBlocks;
+        xmlMutexUnlock(&xmlDictMutex);
+        if (block == 0)
+            return(0);
+        dict->nsNextId = block * XML_DICT_NS_ID_BLOCK;
+        dict->nsEndId = dict->nsNextId + XML_DICT_NS_ID_BLOCK;
+    }
+
+    if ((dict->nsElems + 1 > dict->nsSize / 4 * 3) &&
+        (xmlDictNsGrow(dict) < 0))
+        return(0);
+
+    mask = dict->nsSize - 1;
+    for (i = hstr.hashValue & mask; dict->nsTable[i].name != NULL;
+         i = (i + 1) & mask)
+        ;
+    entry = &dict->nsTable[i];
+    entry->name = hstr.name;
+    entry->hashValue = hstr.hashValue;
+    entry->id = dict->nsNextId++;
+    dict->nsElems++;
+
+    return(entry->id);
+}
+
+/**
+ * Return the namespace URI ID of a string. If `update` is set, the
+ * string is added to the dictionary and gets an ID if needed.
+ * Otherwise, only existing IDs are returned and the dictionary isn't
+ * modified, so that readers of a document can look up IDs from
+ * multiple threads. Each dictionary assigns IDs to the URIs it
+ * was asked for from blocks of XML_DICT_NS_ID_BLOCK IDs which are
+ * never handed out again, so equal IDs always mean equal URIs, even
+ * across dictionaries. Different IDs in the same block mean
+ * different URIs.
+ *
+ * Frozen dictionaries only return existing IDs.
+ *
+ * @param dict  the dictionary
+ * @param href  the namespace URI
+ * @param update  whether to assign a new ID
+ * @returns the ID or 0 if the string has no ID.
+ */
+int
+xmlDictNsId(xmlDict *dict, const xmlChar *href, int update) {
+    if ((dict == NULL) || (href == NULL))
+        return(0);
+
+    if (dict->shards != NULL) {
+        xmlDictShard *shard;
+        unsigned hashValue;
+        size_t len;
+        int id;
+
+        hashValue = xmlDictHashName(dict->seed, href, SIZE_MAX, &len);
+        shard = xmlDictGetShard(dict, hashValue);
+        xmlMutexLock(&shard->mutex);
+        id = xmlDictNsIdInternal(shard->dict, href, update);
+        xmlMutexUnlock(&shard->mutex);
+
+        return(id);
+    }
+
+    return(xmlDictNsIdInternal(dict, href, update));
+}
+
+/*
+ * Snapshot format: magic, number of strings as 32-bit little endian
+ * integer, then the null-terminated strings.
+ */
+#define XML_DICT_MAGIC "XMLDICT1"
+#define XML_DICT_MAGIC_LEN 8
+#define XML_DICT_HEADER_LEN (XML_DICT_MAGIC_LEN + 4)
+
+/**
+ * Add the strings of a dictionary table to a snapshot buffer.
+ * If `out` is NULL, only compute the size.
+ *
+ * @param dict  the dictionary, not concurrent
+ * @param out  output buffer or NULL
+ * @param pos  current offset in the buffer
+ * @param count  incremented by the number of strings
+ * @returns the new offset.
+ */
+static size_t
+xmlDictSaveTable(const xmlDict *dict, unsigned char *out, size_t pos,
+                 unsigned *count) {
+    size_t i;
+
+    for (i = 0; i < dict->size; i++) {
+        const xmlDictEntry *entry = &dict->table[i];
+        size_t len;
+
+        if (entry->hashValue == 0)
+            continue;
+
+        len = strlen((const char *) entry->name) + 1;
+        if (out != NULL)
+            memcpy(&out[pos], entry->name, len);
+        pos += len;
+        *count += 1;
+    }
+
+    return(pos);
+}
+
+/**
+ * Serialize the strings of a dictionary into a snapshot which can be
+ * loaded with #xmlDictLoad, typically to restore a dictionary filled
+ * with frequently used names at startup without parsing schemas or
+ * documents again.
+ *
+ * Strings of a sub-dictionary are not included. The snapshot doesn't
+ * contain hash values, the table is rebuilt with a fresh seed on load.
+ *
+ * @since 2.16.0
+ *
+ * @param dict  the dictionary
+ * @param mem  pointer to the resulting buffer, to be freed with xmlFree
+ * @param size  pointer to the size of the buffer
+ * @returns 0 on success, -1 if arguments are invalid or a memory
+ * allocation failed.
+ */
+int
+xmlDictSave(xmlDict *dict, unsigned char **mem, size_t *size) {
+    unsigned char *out;
+    size_t total, pos;
+    unsigned count = 0;
+    int i;
+
+    if ((mem == NULL) || (size == NULL))
+        return(-1);
+    *mem = NULL;
+    *size = 0;
+    if (dict == NULL)
+        return(-1);
 
-    entry = xmlDictLookupInternal(dict, prefix, name, -1, 1);
-    if (entry == NULL)
+    if (dict->shards != NULL) {
+        for (i = 0; i < XML_DICT_SHARDS; i++)
+            xmlMutexLock(&dict->shards[i].mutex);
+    }
+
+    total = xmlDictSaveTable(dict, NULL, XML_DICT_HEADER_LEN, &count);
+    if (dict->shards != NULL) {
+        for (i = 0; i < XML_DICT_SHARDS; i++)
+            total = xmlDictSaveTable(dict->shards[i].dict, NULL, total,
+                                     &count);
+    }
+
+    out = xmlMalloc(total);
+    if (out != NULL) {
+        memcpy(out, XML_DICT_MAGIC, XML_DICT_MAGIC_LEN);
+        out[XML_DICT_MAGIC_LEN] = count & 0xFF;
+        out[XML_DICT_MAGIC_LEN + 1] = (count >> 8) & 0xFF;
+        out[XML_DICT_MAGIC_LEN + 2] = (count >> 16) & 0xFF;
+        out[XML_DICT_MAGIC_LEN + 3] = (count >> 24) & 0xFF;
+
+        count = 0;
+        pos = xmlDictSaveTable(dict, out, XML_DICT_HEADER_LEN, &count);
+        if (dict->shards != NULL) {
+            for (i = 0; i < XML_DICT_SHARDS; i++)
+                pos = xmlDictSaveTable(dict->shards[i].dict, out, pos,
+                                       &count);
+        }
+    }
+
+    if (dict->shards != NULL) {
+        for (i = XML_DICT_SHARDS - 1; i >= 0; i--)
+            xmlMutexUnlock(&dict->shards[i].mutex);
+    }
+
+    if (out == NULL)
+        return(-1);
+
+    *mem = out;
+    *size = total;
+    return(0);
+}
+
+/**
+ * Create a dictionary from a snapshot made with #xmlDictSave. The
+ * snapshot is validated and can come from an untrusted source. The
+ * string pool and hash table are allocated with their final size
+ * upfront.
+ *
+ * @since 2.16.0
+ *
+ * @param mem  snapshot data, for example a memory-mapped file
+ * @param size  size of the snapshot
+ * @returns the new dictionary or NULL if the snapshot is malformed
+ * or a memory allocation failed.
+ */
+xmlDict *
+xmlDictLoad(const unsigned char *mem, size_t size) {
+    xmlDictPtr dict;
+    xmlDictStringsPtr pool;
+    const unsigned char *cur, *end;
+    unsigned count, i;
+    size_t poolSize;
+
+    if ((mem == NULL) || (size < XML_DICT_HEADER_LEN) ||
+        (memcmp(mem, XML_DICT_MAGIC, XML_DICT_MAGIC_LEN) != 0))
+        return(NULL);
+
+    count = (unsigned) mem[XML_DICT_MAGIC_LEN] |
+            (unsigned) mem[XML_DICT_MAGIC_LEN + 1] << 8 |
+            (unsigned) mem[XML_DICT_MAGIC_LEN + 2] << 16 |
+            (unsigned) mem[XML_DICT_MAGIC_LEN + 3] << 24;
+    cur = mem + XML_DICT_HEADER_LEN;
+    end = mem + size;
+    poolSize = end - cur;
+
+    /* Every string takes at least one byte */
+    if ((count > poolSize) || (count > MAX_HASH_SIZE / 2) ||
+        ((poolSize > 0) && (end[-1] != 0)))
+        return(NULL);
+
+    dict = xmlDictCreate();
+    if (dict == NULL)
         return(NULL);
-    return(entry->name);
+
+    if (count > 0) {
+        if (xmlDictReserveInternal(dict, count) != 0)
+            goto error;
+
+        pool = xmlMalloc(sizeof(xmlDictStrings) + poolSize);
+        if (pool == NULL)
+            goto error;
+        pool->size = poolSize;
+        pool->nbStrings = 0;
+        pool->free = &pool->array[0];
+        pool->end = &pool->array[poolSize];
+        pool->next = NULL;
+        dict->strings = pool;
+    }
+
+    for (i = 0; i < count; i++) {
+        const unsigned char *str = cur;
+        size_t len;
+
+        /* The last byte was checked to be zero */
+        while (*cur != 0)
+            cur++;
+        len = cur - str;
+        cur++;
+
+        if ((len > INT_MAX / 2) ||
+            (xmlDictLookupInternal(dict, NULL, str, len, 1, 0) == NULL))
+            goto error;
+
+        if ((cur >= end) && (i + 1 < count))
+            goto error;
+    }
+
+    if (cur != end)
+        goto error;
+
+    return(dict);
+
+error:
+    xmlDictFree(dict);
+    return(NULL);
 }
 
 /*
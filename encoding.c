@@ -45,6 +45,9 @@
 #include "private/enc.h"
 #include "private/error.h"
 #include "private/memory.h"
+#include "private/simd.h"
+#include "private/threads.h"
+#include "private/trace.h"
 
 #ifdef LIBXML_ICU_ENABLED
 #include <unicode/ucnv.h>
@@ -290,7 +293,7 @@ Utf8ToEightBit(void *vctxt, unsigned char *out, int *outlen,
 
 #define MAKE_8BIT_HANDLER(name, table) \
     { (char *) name, { EightBitToUtf8 }, { Utf8ToEightBit }, \
-      (void *) xmlunicodetable_##table, \
+      (void *) xmlutf8table_##table, \
       (void *) xmltranscodetable_##table, \
       NULL, XML_HANDLER_STATIC }
 
@@ -1205,6 +1208,167 @@ xmlFindCharEncodingHandler(const char *name) {
     return(ret);
 }
 
+/************************************************************************
+ *									*
+ *		Converter pool						*
+ *									*
+ ************************************************************************/
+
+#if defined(LIBXML_ICONV_ENABLED) || defined(LIBXML_ICU_ENABLED)
+/*
+ * Opening an iconv or ICU converter is expensive compared to
+ * converting a small document. Converters released by
+ * xmlCharEncCloseFunc are reset and kept in a small pool, keyed by
+ * backend, direction and normalized encoding name.
+ */
+#define XML_CONV_POOL_SIZE 16
+#define XML_CONV_NAME_MAX 32
+
+#define XML_CONV_ICONV  1
+#define XML_CONV_ICU    2
+
+/*
+ * Only the backend handles are pooled. They aren't allocated with
+ * xmlMalloc, so they don't show up in memory debugging.
+ */
+typedef struct {
+    int backend;
+    int output;
+#ifdef LIBXML_ICONV_ENABLED
+    iconv_t cd;
+#endif
+#ifdef LIBXML_ICU_ENABLED
+    UConverter *uconv;
+    UConverter *utf8;
+#endif
+    char name[XML_CONV_NAME_MAX];
+} xmlConvPoolEntry;
+
+static xmlMutex xmlConvPoolMutex;
+static xmlConvPoolEntry xmlConvPool[XML_CONV_POOL_SIZE];
+static int xmlConvPoolUsed;
+
+/**
+ * Normalize an encoding name to use as pool key.
+ *
+ * @param name  encoding name
+ * @param key  output buffer of size XML_CONV_NAME_MAX
+ * @returns 0 on success or -1 if the name is too long.
+ */
+static int
+xmlConvPoolKey(const char *name, char *key) {
+    int i;
+
+    for (i = 0; name[i] != 0; i++) {
+        if (i >= XML_CONV_NAME_MAX - 1)
+            return(-1);
+        key[i] = toupper((unsigned char) name[i]);
+    }
+    key[i] = 0;
+
+    return(0);
+}
+
+static void
+xmlConvPoolClose(xmlConvPoolEntry *entry) {
+#ifdef LIBXML_ICONV_ENABLED
+    if (entry->backend == XML_CONV_ICONV)
+        iconv_close(entry->cd);
+#endif
+#ifdef LIBXML_ICU_ENABLED
+    if (entry->backend == XML_CONV_ICU) {
+        ucnv_close(entry->uconv);
+        ucnv_close(entry->utf8);
+    }
+#endif
+}
+
+/**
+ * Take converter handles from the pool.
+ *
+ * @param backend  XML_CONV_ICONV or XML_CONV_ICU
+ * @param key  normalized encoding name
+ * @param output  whether the converter is for output
+ * @param out  entry receiving the handles
+ * @returns 0 if handles were found, -1 otherwise.
+ */
+static int
+xmlConvPoolGet(int backend, const char *key, int output,
+               xmlConvPoolEntry *out) {
+    int ret = -1;
+    int i;
+
+    if (key[0] == 0)
+        return(-1);
+
+    xmlMutexLock(&xmlConvPoolMutex);
+    for (i = xmlConvPoolUsed - 1; i >= 0; i--) {
+        xmlConvPoolEntry *entry = &xmlConvPool[i];
+
+        if ((entry->backend == backend) && (entry->output == output) &&
+            (strcmp(entry->name, key) == 0)) {
+            *out = *entry;
+            xmlConvPoolUsed -= 1;
+            *entry = xmlConvPool[xmlConvPoolUsed];
+            ret = 0;
+            break;
+        }
+    }
+    xmlMutexUnlock(&xmlConvPoolMutex);
+
+    return(ret);
+}
+
+/**
+ * Return converter handles in their initial state to the pool.
+ * If the pool is full, the handles are closed.
+ *
+ * @param entry  the handles and their key
+ */
+static void
+xmlConvPoolPut(xmlConvPoolEntry *entry) {
+    int stored = 0;
+
+    if (entry->name[0] != 0) {
+        xmlMutexLock(&xmlConvPoolMutex);
+        if (xmlConvPoolUsed < XML_CONV_POOL_SIZE) {
+            xmlConvPool[xmlConvPoolUsed++] = *entry;
+            stored = 1;
+        }
+        xmlMutexUnlock(&xmlConvPoolMutex);
+    }
+
+    if (!stored)
+        xmlConvPoolClose(entry);
+}
+#endif /* LIBXML_ICONV_ENABLED || LIBXML_ICU_ENABLED */
+
+/**
+ * Initialize the converter pool.
+ */
+void
+xmlInitConvPoolInternal(void) {
+#if defined(LIBXML_ICONV_ENABLED) || defined(LIBXML_ICU_ENABLED)
+    xmlInitMutex(&xmlConvPoolMutex);
+#endif
+}
+
+/**
+ * Close all pooled converters.
+ */
+void
+xmlCleanupConvPoolInternal(void) {
+#if defined(LIBXML_ICONV_ENABLED) || defined(LIBXML_ICU_ENABLED)
+    int i;
+
+    for (i = 0; i < xmlConvPoolUsed; i++)
+        xmlConvPoolClose(&xmlConvPool[i]);
+    xmlConvPoolUsed = 0;
+
+    xmlCleanupMutex(&xmlConvPoolMutex);
+#endif
+}
+
 /************************************************************************
  *									*
  *		ICONV based generic conversion functions		*
@@ -1214,6 +1378,8 @@ xmlFindCharEncodingHandler(const char *name) {
 #ifdef LIBXML_ICONV_ENABLED
 typedef struct {
     iconv_t cd;
+    int output;
+    char key[XML_CONV_NAME_MAX];
 } xmlIconvCtxt;
 
 /**
@@ -1281,12 +1447,71 @@ xmlIconvFree(void *vctxt) {
     if (ctxt == NULL)
         return;
 
-    if (ctxt->cd != (iconv_t) -1)
-        iconv_close(ctxt->cd);
+    if (ctxt->cd != (iconv_t) -1) {
+        if (iconv(ctxt->cd, NULL, NULL, NULL, NULL) == (size_t) -1) {
+            iconv_close(ctxt->cd);
+        } else {
+            xmlConvPoolEntry entry;
+
+            entry.backend = XML_CONV_ICONV;
+            entry.output = ctxt->output;
+            entry.cd = ctxt->cd;
+            memcpy(entry.name, ctxt->key, XML_CONV_NAME_MAX);
+            xmlConvPoolPut(&entry);
+        }
+    }
 
     xmlFree(ctxt);
 }
 
+/**
+ * Create an iconv context, reusing a pooled descriptor if possible.
+ *
+ * @param name  encoding name
+ * @param key  normalized name or empty string
+ * @param output  whether to convert from UTF-8
+ * @param out  pointer to resulting context
+ * @returns an xmlParserErrors code.
+ */
+static xmlParserErrors
+xmlIconvOpen(const char *name, const char *key, int output,
+             xmlIconvCtxt **out) {
+    xmlIconvCtxt *ctxt;
+    xmlConvPoolEntry entry;
+
+    *out = NULL;
+
+    ctxt = xmlMalloc(sizeof(xmlIconvCtxt));
+    if (ctxt == NULL)
+        return(XML_ERR_NO_MEMORY);
+    ctxt->output = output;
+    memcpy(ctxt->key, key, XML_CONV_NAME_MAX);
+
+    if (xmlConvPoolGet(XML_CONV_ICONV, key, output, &entry) == 0) {
+        ctxt->cd = entry.cd;
+    } else {
+        if (output)
+            ctxt->cd = iconv_open(name, "UTF-8");
+        else
+            ctxt->cd = iconv_open("UTF-8", name);
+        if (ctxt->cd == (iconv_t) -1) {
+            xmlParserErrors ret;
+
+            if (errno == EINVAL)
+                ret = XML_ERR_UNSUPPORTED_ENCODING;
+            else if (errno == ENOMEM)
+                ret = XML_ERR_NO_MEMORY;
+            else
+                ret = XML_ERR_SYSTEM;
+            xmlFree(ctxt);
+            return(ret);
+        }
+    }
+
+    *out = ctxt;
+    return(XML_ERR_OK);
+}
+
 #if defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION) && \
     defined(__GLIBC__)
 #include <libxml/parserInternals.h>
@@ -1318,8 +1543,7 @@ xmlCharEncIconv(const char *name, xmlCharEncFlags flags,
                 xmlCharEncodingHandler **out) {
     xmlCharEncConvFunc inFunc = NULL, outFunc = NULL;
     xmlIconvCtxt *inputCtxt = NULL, *outputCtxt = NULL;
-    iconv_t icv_in;
-    iconv_t icv_out;
+    char key[XML_CONV_NAME_MAX];
     xmlParserErrors ret;
 
     /*
@@ -1369,49 +1593,21 @@ xmlCharEncIconv(const char *name, xmlCharEncFlags flags,
     }
 #endif
 
-    if (flags & XML_ENC_INPUT) {
-        inputCtxt = xmlMalloc(sizeof(xmlIconvCtxt));
-        if (inputCtxt == NULL) {
-            ret = XML_ERR_NO_MEMORY;
-            goto error;
-        }
-        inputCtxt->cd = (iconv_t) -1;
+    /* Names too long to be pooled get an empty key */
+    if (xmlConvPoolKey(name, key) < 0)
+        key[0] = 0;
 
-        icv_in = iconv_open("UTF-8", name);
-        if (icv_in == (iconv_t) -1) {
-            if (errno == EINVAL)
-                ret = XML_ERR_UNSUPPORTED_ENCODING;
-            else if (errno == ENOMEM)
-                ret = XML_ERR_NO_MEMORY;
-            else
-                ret = XML_ERR_SYSTEM;
+    if (flags & XML_ENC_INPUT) {
+        ret = xmlIconvOpen(name, key, 0, &inputCtxt);
+        if (ret != XML_ERR_OK)
             goto error;
-        }
-        inputCtxt->cd = icv_in;
-
         inFunc = xmlIconvConvert;
     }
 
     if (flags & XML_ENC_OUTPUT) {
-        outputCtxt = xmlMalloc(sizeof(xmlIconvCtxt));
-        if (outputCtxt == NULL) {
-            ret = XML_ERR_NO_MEMORY;
-            goto error;
-        }
-        outputCtxt->cd = (iconv_t) -1;
-
-        icv_out = iconv_open(name, "UTF-8");
-        if (icv_out == (iconv_t) -1) {
-            if (errno == EINVAL)
-                ret = XML_ERR_UNSUPPORTED_ENCODING;
-            else if (errno == ENOMEM)
-                ret = XML_ERR_NO_MEMORY;
-            else
-                ret = XML_ERR_SYSTEM;
+        ret = xmlIconvOpen(name, key, 1, &outputCtxt);
+        if (ret != XML_ERR_OK)
             goto error;
-        }
-        outputCtxt->cd = icv_out;
-
         outFunc = xmlIconvConvert;
     }
 
@@ -1444,6 +1640,7 @@ struct _uconv_t {
   UChar      *pivot_source;
   UChar      *pivot_target;
   int        isInput;
+  char       key[XML_CONV_NAME_MAX];
   UChar      pivot_buf[ICU_PIVOT_BUF_SIZE];
 };
 
@@ -1532,10 +1729,12 @@ xmlUconvConvert(void *vctxt, unsigned char *out, int *outlen,
 }
 
 static xmlParserErrors
-openIcuConverter(const char* name, int isInput, xmlUconvCtxt **out)
+openIcuConverter(const char* name, const char *key, int isInput,
+                 xmlUconvCtxt **out)
 {
     UErrorCode status;
     xmlUconvCtxt *conv;
+    xmlConvPoolEntry entry;
 
     *out = NULL;
 
@@ -1544,9 +1743,17 @@ openIcuConverter(const char* name, int isInput, xmlUconvCtxt **out)
         return(XML_ERR_NO_MEMORY);
 
     conv->isInput = isInput;
+    memcpy(conv->key, key, XML_CONV_NAME_MAX);
     conv->pivot_source = conv->pivot_buf;
     conv->pivot_target = conv->pivot_buf;
 
+    if (xmlConvPoolGet(XML_CONV_ICU, key, !isInput, &entry) == 0) {
+        conv->uconv = entry.uconv;
+        conv->utf8 = entry.utf8;
+        *out = conv;
+        return(XML_ERR_OK);
+    }
+
     status = U_ZERO_ERROR;
     conv->uconv = ucnv_open(name, &status);
     if (U_FAILURE(status))
@@ -1587,10 +1794,21 @@ error:
 static void
 closeIcuConverter(xmlUconvCtxt *conv)
 {
+    xmlConvPoolEntry entry;
+
     if (conv == NULL)
         return;
-    ucnv_close(conv->uconv);
-    ucnv_close(conv->utf8);
+
+    ucnv_reset(conv->uconv);
+    ucnv_reset(conv->utf8);
+
+    entry.backend = XML_CONV_ICU;
+    entry.output = !conv->isInput;
+    entry.uconv = conv->uconv;
+    entry.utf8 = conv->utf8;
+    memcpy(entry.name, conv->key, XML_CONV_NAME_MAX);
+    xmlConvPoolPut(&entry);
+
     xmlFree(conv);
 }
 
@@ -1605,17 +1823,21 @@ xmlCharEncUconv(const char *name, xmlCharEncFlags flags,
     xmlCharEncConvFunc inFunc = NULL, outFunc = NULL;
     xmlUconvCtxt *ucv_in = NULL;
     xmlUconvCtxt *ucv_out = NULL;
+    char key[XML_CONV_NAME_MAX];
     int ret;
 
+    if (xmlConvPoolKey(name, key) < 0)
+        key[0] = 0;
+
     if (flags & XML_ENC_INPUT) {
-        ret = openIcuConverter(name, 1, &ucv_in);
+        ret = openIcuConverter(name, key, 1, &ucv_in);
         if (ret != 0)
             goto error;
         inFunc = xmlUconvConvert;
     }
 
     if (flags & XML_ENC_OUTPUT) {
-        ret = openIcuConverter(name, 0, &ucv_out);
+        ret = openIcuConverter(name, key, 0, &ucv_out);
         if (ret != 0)
             goto error;
         outFunc = xmlUconvConvert;
@@ -1778,19 +2000,12 @@ xmlCharEncFirstLine(xmlCharEncodingHandler *handler, struct _xmlBuffer *out,
     return(xmlCharEncInFunc(handler, out, in));
 }
 
-/**
- * Generic front-end for input encoding conversion.
- *
- * `sizeOut` should be set to the maximum output size (or SIZE_MAX).
- * After return, it is set to the number of bytes written.
- *
- * @param input  a parser input buffer
- * @param sizeOut  pointer to output size
- * @param flush  end of input
- * @returns an xmlCharEncError code.
+/*
+ * Conversion loop of xmlCharEncInput which adds the optional timing.
  */
-xmlCharEncError
-xmlCharEncInput(xmlParserInputBuffer *input, size_t *sizeOut, int flush)
+static xmlCharEncError
+xmlCharEncInputInternal(xmlParserInputBufferPtr input, size_t *sizeOut,
+                        int flush)
 {
     xmlBufPtr out, in;
     const xmlChar *dataIn;
@@ -1880,6 +2095,33 @@ xmlCharEncInput(xmlParserInputBuffer *input, size_t *sizeOut, int flush)
     return(XML_ENC_ERR_SUCCESS);
 }
 
+/**
+ * Generic front-end for input encoding conversion.
+ *
+ * `sizeOut` should be set to the maximum output size (or SIZE_MAX).
+ * After return, it is set to the number of bytes written.
+ *
+ * @param input  a parser input buffer
+ * @param sizeOut  pointer to output size
+ * @param flush  end of input
+ * @returns an xmlCharEncError code.
+ */
+xmlCharEncError
+xmlCharEncInput(xmlParserInputBuffer *input, size_t *sizeOut, int flush)
+{
+    xmlCharEncError ret;
+    double start;
+
+    if (!input->convTiming)
+        return(xmlCharEncInputInternal(input, sizeOut, flush));
+
+    start = xmlTraceTime();
+    ret = xmlCharEncInputInternal(input, sizeOut, flush);
+    input->convTime += xmlTraceTime() - start;
+
+    return(ret);
+}
+
 /**
  * Generic front-end for input encoding conversion.
  *
@@ -2079,6 +2321,68 @@ error:
 
     return(writtentot);
 }
+
+/**
+ * Check whether a handler is one of the built-in single-byte output
+ * encoders for ASCII-compatible charsets. Text for these encoders
+ * can be escaped and encoded in a single pass with
+ * #xmlCharEncOutputChar.
+ *
+ * @param handler  encoding handler
+ * @returns 1 if the handler is a single-byte encoder, 0 otherwise.
+ */
+int
+xmlCharEncIsSingleByte(const xmlCharEncodingHandler *handler) {
+    xmlCharEncConvFunc func;
+
+    if ((handler == NULL) || (handler->flags & XML_HANDLER_LEGACY))
+        return(0);
+
+    func = handler->output.func;
+    return((func == UTF8ToLatin1) ||
+           (func == asciiToAscii) ||
+           (func == Utf8ToEightBit));
+}
+
+/**
+ * Encode a single non-ASCII character with a single-byte encoder.
+ * Characters which can't be represented are replaced with a
+ * decimal character reference like #xmlCharEncOutput does.
+ *
+ * @param handler  a handler accepted by #xmlCharEncIsSingleByte
+ * @param c  the code point
+ * @param out  output buffer with room for 10 bytes
+ * @returns the number of bytes written.
+ */
+int
+xmlCharEncOutputChar(const xmlCharEncodingHandler *handler, int c,
+                     char *out) {
+    xmlCharEncConvFunc func = handler->output.func;
+    int d = 0;
+
+    if (func == UTF8ToLatin1) {
+        if (c < 0x100)
+            d = c;
+    } else if (func == Utf8ToEightBit) {
+        const unsigned char *xlattable = handler->outputCtxt;
+
+        if (c < 0x800) {
+            d = xlattable[48 + (c & 0x3F) + xlattable[c >> 6] * 64];
+        } else if (c < 0x10000) {
+            d = xlattable[48 + (c & 0x3F) +
+                          xlattable[48 + ((c >> 6) & 0x3F) +
+                                    xlattable[32 + (c >> 12)] * 64] * 64];
+        }
+    } else if (c < 0x80) {
+        d = c;
+    }
+
+    if (d == 0)
+        return(xmlSerializeDecCharRef(out, c));
+
+    out[0] = d;
+    return(1);
+}
 #endif
 
 /**
@@ -2300,8 +2604,17 @@ asciiToAscii(void *vctxt ATTRIBUTE_UNUSED,
     *pinlen = inlen;
 
     while (in < inend) {
-	unsigned c = *in;
+	unsigned c;
+        size_t n;
+
+        n = xmlCopyAscii(out, in, inend - in);
+        if (n > 0) {
+            in += n;
+            out += n;
+            continue;
+        }
 
+        c = *in;
         if (c >= 0x80) {
 	    *poutlen = in - instart;
 	    *pinlen = in - instart;
@@ -2336,8 +2649,18 @@ latin1ToUTF8(void *vctxt ATTRIBUTE_UNUSED,
         unsigned c = *in;
 
 	if (c < 0x80) {
-            if (out >= outend)
+            size_t avail = outend - out, n;
+
+            if (avail == 0)
                 goto done;
+            if (avail > (size_t) (inend - in))
+                avail = inend - in;
+            n = xmlCopyAscii(out, in, avail);
+            if (n > 0) {
+                in += n;
+                out += n;
+                continue;
+            }
             *out++ = c;
 	} else {
             if (outend - out < 2)
@@ -2438,6 +2761,16 @@ UTF8ToLatin1(void *vctxt ATTRIBUTE_UNUSED,
 	c = *in;
 
         if (c < 0x80) {
+            size_t avail = outend - out, n;
+
+            if (avail > (size_t) (inend - in))
+                avail = inend - in;
+            n = xmlCopyAscii(out, in, avail);
+            if (n > 0) {
+                in += n;
+                out += n;
+                continue;
+            }
             *out++ = c;
         } else if ((c >= 0xC2) && (c <= 0xC3)) {
             if (inend - in < 2)
@@ -2500,8 +2833,18 @@ UTF16LEToUTF8(void *vctxt ATTRIBUTE_UNUSED,
         c = in[0] | (in[1] << 8);
 
         if (c < 0x80) {
+            size_t avail = (inend - in) / 2, n;
+
             if (out >= outend)
                 goto done;
+            if ((size_t) (outend - out) < avail)
+                avail = outend - out;
+            n = xmlUtf16ToAscii(out, in, avail, 0);
+            if (n > 0) {
+                in += 2 * n;
+                out += n;
+                continue;
+            }
             out[0] = c;
             in += 2;
             out += 1;
@@ -2580,8 +2923,18 @@ UTF8ToUTF16LE(void *vctxt ATTRIBUTE_UNUSED,
         c = in[0];
 
         if (c < 0x80) {
+            size_t avail = (outend - out) / 2, n;
+
             if (out >= outend)
                 goto done;
+            if ((size_t) (inend - in) < avail)
+                avail = inend - in;
+            n = xmlAsciiToUtf16(out, in, avail, 0);
+            if (n > 0) {
+                in += n;
+                out += 2 * n;
+                continue;
+            }
             out[0] = c;
             out[1] = 0;
             in += 1;
@@ -2697,8 +3050,18 @@ UTF16BEToUTF8(void *vctxt ATTRIBUTE_UNUSED,
         c = (in[0] << 8) | in[1];
 
         if (c < 0x80) {
+            size_t avail = (inend - in) / 2, n;
+
             if (out >= outend)
                 goto done;
+            if ((size_t) (outend - out) < avail)
+                avail = outend - out;
+            n = xmlUtf16ToAscii(out, in, avail, 1);
+            if (n > 0) {
+                in += 2 * n;
+                out += n;
+                continue;
+            }
             out[0] = c;
             in += 2;
             out += 1;
@@ -2776,8 +3139,18 @@ UTF8ToUTF16BE(void *vctxt ATTRIBUTE_UNUSED,
         c = in[0];
 
         if (c < 0x80) {
+            size_t avail = (outend - out) / 2, n;
+
             if (out >= outend)
                 goto done;
+            if ((size_t) (inend - in) < avail)
+                avail = inend - in;
+            n = xmlAsciiToUtf16(out, in, avail, 1);
+            if (n > 0) {
+                in += n;
+                out += 2 * n;
+                continue;
+            }
             out[0] = 0;
             out[1] = c;
             in += 1;
@@ -2891,8 +3264,18 @@ Utf8ToEightBit(void *vctxt,
         unsigned d = *in;
 
         if  (d < 0x80)  {
-            if (out >= outend)
+            size_t avail = outend - out, n;
+
+            if (avail == 0)
                 goto done;
+            if (avail > (size_t) (inend - in))
+                avail = inend - in;
+            n = xmlCopyAscii(out, in, avail);
+            if (n > 0) {
+                in += n;
+                out += n;
+                continue;
+            }
             in += 1;
         } else if (d < 0xE0) {
             unsigned c;
@@ -2951,7 +3334,7 @@ EightBitToUtf8(void *vctxt,
                unsigned char* out, int *outlen,
                const unsigned char* in, int *inlen,
                int flush ATTRIBUTE_UNUSED) {
-    unsigned short const *unicodetable = vctxt;
+    const unsigned char *utf8table = vctxt;
     const unsigned char* instart = in;
     const unsigned char* inend;
     unsigned char* outstart = out;
@@ -2965,28 +3348,36 @@ EightBitToUtf8(void *vctxt,
         unsigned c = *in;
 
         if (c < 0x80) {
-            if (out >= outend)
+            size_t avail = outend - out, n;
+
+            if (avail == 0)
                 goto done;
+            if (avail > (size_t) (inend - in))
+                avail = inend - in;
+            n = xmlCopyAscii(out, in, avail);
+            if (n > 0) {
+                in += n;
+                out += n;
+                continue;
+            }
             *out++ = c;
         } else {
-            c = unicodetable[c - 0x80];
-            if (c == 0) {
+            /* Length and bytes of the UTF-8 sequence */
+            const unsigned char *seq = utf8table + (c - 0x80) * 4;
+            unsigned len = seq[0];
+
+            if (len == 0) {
                 /* undefined code point */
                 ret = XML_ENC_ERR_INPUT;
                 goto done;
             }
-            if (c < 0x800) {
-                if (outend - out < 2)
-                    goto done;
-                *out++ = ((c >>  6) & 0x1F) | 0xC0;
-                *out++ = (c & 0x3F) | 0x80;
-            } else {
-                if (outend - out < 3)
-                    goto done;
-                *out++ = ((c >>  12) & 0x0F) | 0xE0;
-                *out++ = ((c >>  6) & 0x3F) | 0x80;
-                *out++ = (c & 0x3F) | 0x80;
-            }
+            if ((unsigned) (outend - out) < len)
+                goto done;
+            out[0] = seq[1];
+            out[1] = seq[2];
+            if (len == 3)
+                out[2] = seq[3];
+            out += len;
         }
 
         in += 1;
@@ -517,19 +517,43 @@ xmlGetDocEntity(const xmlDoc *doc, const xmlChar *name) {
  * @param input  A string to convert to XML.
  * @returns a newly allocated string with substitutions.
  */
+static int
+xmlEncodeEntitiesFlags(const xmlDoc *doc) {
+    if ((doc != NULL) && (doc->type == XML_HTML_DOCUMENT_NODE))
+        return(XML_ESCAPE_HTML);
+    if ((doc == NULL) || (doc->encoding == NULL))
+        return(XML_ESCAPE_NON_ASCII);
+    return(0);
+}
+
 xmlChar *
 xmlEncodeEntitiesReentrant(xmlDoc *doc, const xmlChar *input) {
-    int flags = 0;
-
     if (input == NULL)
         return(NULL);
 
-    if ((doc != NULL) && (doc->type == XML_HTML_DOCUMENT_NODE))
-        flags |= XML_ESCAPE_HTML;
-    else if ((doc == NULL) || (doc->encoding == NULL))
-        flags |= XML_ESCAPE_NON_ASCII;
+    return(xmlEscapeText(input, xmlEncodeEntitiesFlags(doc)));
+}
 
-    return(xmlEscapeText(input, flags));
+/**
+ * Like #xmlEncodeEntitiesReentrant, but returns `input` itself if
+ * no character needs to be replaced. This saves a copy when most
+ * strings are plain text.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  the document containing the string (optional)
+ * @param input  A string to convert to XML.
+ * @returns `input` or a newly allocated string with substitutions,
+ * NULL if a memory allocation failed. The result must only be freed
+ * if it differs from `input`.
+ */
+xmlChar *
+xmlEncodeEntitiesNoCopy(xmlDoc *doc, const xmlChar *input) {
+    if (input == NULL)
+        return(NULL);
+
+    return(xmlEscapeText(input,
+                         xmlEncodeEntitiesFlags(doc) | XML_ESCAPE_NO_COPY));
 }
 
 /**
@@ -552,6 +576,27 @@ xmlEncodeSpecialChars(const xmlDoc *doc ATTRIBUTE_UNUSED,
     return(xmlEscapeText(input, XML_ESCAPE_QUOT));
 }
 
+/**
+ * Like #xmlEncodeSpecialChars, but returns `input` itself if no
+ * character needs to be replaced.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  unused
+ * @param input  A string to convert to XML.
+ * @returns `input` or a newly allocated string with substitutions,
+ * NULL if a memory allocation failed. The result must only be freed
+ * if it differs from `input`.
+ */
+xmlChar *
+xmlEncodeSpecialCharsNoCopy(const xmlDoc *doc ATTRIBUTE_UNUSED,
+                            const xmlChar *input) {
+    if (input == NULL)
+        return(NULL);
+
+    return(xmlEscapeText(input, XML_ESCAPE_QUOT | XML_ESCAPE_NO_COPY));
+}
+
 /**
  * Create and initialize an empty entities hash table.
  *
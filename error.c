@@ -9,6 +9,7 @@
 #define IN_LIBXML
 #include "libxml.h"
 
+#include <limits.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -18,6 +19,7 @@
 
 #include "private/error.h"
 #include "private/globals.h"
+#include "private/memory.h"
 #include "private/parser.h"
 #include "private/string.h"
 
@@ -169,46 +171,63 @@ xmlSetError(xmlError *err,
     return(res);
 }
 
-static int
-xmlVUpdateError(xmlError *err,
-                void *ctxt, xmlNodePtr node,
-                int domain, int code, xmlErrorLevel level,
-                const char *file, int line,
-                const char *str1, const char *str2, const char *str3,
-                int int1, int col,
-                const char *fmt, va_list ap)
-{
-    int res;
+/**
+ * Find the first element parent of a node and get file and line
+ * from it unless they are already known.
+ *
+ * @param node  pointer to the node (optional)
+ * @param file  pointer to the file name (optional)
+ * @param line  pointer to the line number
+ */
+static void
+xmlErrorNodeInfo(xmlNodePtr *node, const char **file, int *line) {
+    xmlNodePtr cur = *node;
 
     /*
      * Find first element parent.
      */
-    if (node != NULL) {
+    if (cur != NULL) {
         int i;
 
         for (i = 0; i < 10; i++) {
-            if ((node->type == XML_ELEMENT_NODE) ||
-                (node->parent == NULL))
+            if ((cur->type == XML_ELEMENT_NODE) ||
+                (cur->parent == NULL))
                 break;
-            node = node->parent;
+            cur = cur->parent;
         }
     }
 
     /*
      * Get file and line from node.
      */
-    if (node != NULL) {
-        if ((file == NULL) && (node->doc != NULL))
-            file = (const char *) node->doc->URL;
-
-        if (line == 0) {
-            if (node->type == XML_ELEMENT_NODE)
-                line = node->line;
-            if ((line == 0) || (line == 65535))
-                line = xmlGetLineNo(node);
+    if (cur != NULL) {
+        if ((file != NULL) && (*file == NULL) && (cur->doc != NULL))
+            *file = (const char *) cur->doc->URL;
+
+        if (*line == 0) {
+            if (cur->type == XML_ELEMENT_NODE)
+                *line = cur->line;
+            if ((*line == 0) || (*line == 65535))
+                *line = xmlGetLineNo(cur);
         }
     }
 
+    *node = cur;
+}
+
+static int
+xmlVUpdateError(xmlError *err,
+                void *ctxt, xmlNodePtr node,
+                int domain, int code, xmlErrorLevel level,
+                const char *file, int line,
+                const char *str1, const char *str2, const char *str3,
+                int int1, int col,
+                const char *fmt, va_list ap)
+{
+    int res;
+
+    xmlErrorNodeInfo(&node, &file, &line);
+
     res = xmlVSetError(err, ctxt, node, domain, code, level, file, line,
                        str1, str2, str3, int1, col, fmt, ap);
 
@@ -423,6 +442,7 @@ xmlFormatError(const xmlError *err, xmlGenericErrorFunc channel, void *data)
     xmlParserCtxtPtr ctxt = NULL;
     xmlParserInputPtr input = NULL;
     xmlParserInputPtr cur = NULL;
+    char *deferred = NULL;
 
     if ((err == NULL) || (channel == NULL))
         return;
@@ -444,6 +464,11 @@ xmlFormatError(const xmlError *err, xmlGenericErrorFunc channel, void *data)
 	ctxt = err->ctxt;
     }
 
+    if ((message == NULL) && (ctxt != NULL) && (ctxt->errorRing != NULL)) {
+        deferred = xmlCtxtFormatDeferredError(ctxt, err);
+        message = deferred;
+    }
+
     if ((node != NULL) && (node->type == XML_ELEMENT_NODE) &&
         (domain != XML_FROM_SCHEMASV))
         name = node->name;
@@ -618,6 +643,8 @@ xmlFormatError(const xmlError *err, xmlGenericErrorFunc channel, void *data)
 	buf[i] = 0;
 	channel(data, "%s\n", buf);
     }
+
+    xmlFree(deferred);
 }
 
 /**
@@ -625,7 +652,8 @@ xmlFormatError(const xmlError *err, xmlGenericErrorFunc channel, void *data)
  * error to an error handler.
  *
  * This function doesn't make memory allocations which are likely
- * to fail after an OOM error.
+ * to fail after an OOM error. Failures caused by an exceeded memory
+ * budget are reported as XML_ERR_RESOURCE_LIMIT.
  *
  * @param schannel  the structured callback channel
  * @param channel  the old callback channel
@@ -638,16 +666,21 @@ xmlRaiseMemoryError(xmlStructuredErrorFunc schannel, xmlGenericErrorFunc channel
                     void *data, int domain, xmlError *error)
 {
     xmlError *lastError = xmlGetLastErrorInternal();
+    int code = XML_ERR_NO_MEMORY;
+
+    /* Allocations fail on purpose if a memory budget is exceeded */
+    if (xmlMemBudgetExceeded())
+        code = XML_ERR_RESOURCE_LIMIT;
 
     xmlResetLastError();
     lastError->domain = domain;
-    lastError->code = XML_ERR_NO_MEMORY;
+    lastError->code = code;
     lastError->level = XML_ERR_FATAL;
 
     if (error != NULL) {
         xmlResetError(error);
         error->domain = domain;
-        error->code = XML_ERR_NO_MEMORY;
+        error->code = code;
         error->level = XML_ERR_FATAL;
     }
 
@@ -656,7 +689,10 @@ xmlRaiseMemoryError(xmlStructuredErrorFunc schannel, xmlGenericErrorFunc channel
     } else if (xmlStructuredError != NULL) {
         xmlStructuredError(xmlStructuredErrorContext, lastError);
     } else if (channel != NULL) {
-        channel(data, "libxml2: out of memory\n");
+        if (code == XML_ERR_RESOURCE_LIMIT)
+            channel(data, "libxml2: memory budget exceeded\n");
+        else
+            channel(data, "libxml2: out of memory\n");
     }
 }
 
@@ -787,6 +823,711 @@ xmlRaiseError(xmlStructuredErrorFunc schannel,
     return(res);
 }
 
+/************************************************************************
+ *									*
+ *			Deferred errors					*
+ *									*
+ ************************************************************************/
+
+/*
+ * A conversion specification of a format string.
+ */
+typedef struct {
+    const char *end;
+    int stars;
+    int precision;
+    int longs;
+    char length;
+    char conv;
+} xmlErrorSpec;
+
+/**
+ * Parse a conversion specification.
+ *
+ * @param cur  pointer to the '%' character
+ * @param spec  the result
+ * @returns 0 on success or -1 if the specification isn't supported.
+ */
+static int
+xmlErrorParseSpec(const char *cur, xmlErrorSpec *spec) {
+    spec->stars = 0;
+    spec->precision = -1;
+    spec->longs = 0;
+    spec->length = 0;
+
+    cur++;
+    while ((*cur == '-') || (*cur == '+') || (*cur == ' ') ||
+           (*cur == '#') || (*cur == '0'))
+        cur++;
+    if (*cur == '*') {
+        spec->stars++;
+        cur++;
+    } else {
+        while ((*cur >= '0') && (*cur <= '9'))
+            cur++;
+    }
+    if (*cur == '.') {
+        cur++;
+        if (*cur == '*') {
+            spec->stars++;
+            spec->precision = -2;
+            cur++;
+        } else {
+            spec->precision = 0;
+            while ((*cur >= '0') && (*cur <= '9')) {
+                if (spec->precision < 100000)
+                    spec->precision = spec->precision * 10 + (*cur - '0');
+                cur++;
+            }
+        }
+    }
+    while (*cur == 'l') {
+        spec->longs++;
+        cur++;
+    }
+    if ((*cur == 'h') || (*cur == 'z')) {
+        spec->length = *cur;
+        cur++;
+        if (*cur == 'h')
+            cur++;
+    }
+    if ((spec->longs > 2) || ((spec->longs > 0) && (spec->length != 0)))
+        return(-1);
+
+    spec->conv = *cur;
+    switch (*cur) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        case 'c': case 's': case 'p': case '%':
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+            break;
+        default:
+            return(-1);
+    }
+    spec->end = cur + 1;
+
+    return(0);
+}
+
+/**
+ * Copy a string argument into the inline buffer of a record.
+ *
+ * @param rec  the record
+ * @param str  the string
+ * @param max  maximum number of bytes or -1
+ * @returns the offset of the copy.
+ */
+static int
+xmlErrorRecordString(xmlErrorRecord *rec, const char *str, int max) {
+    unsigned avail = XML_ERR_RECORD_STR_SIZE - rec->strUsed;
+    unsigned len = 0;
+    int ret;
+
+    if (avail == 0)
+        return(XML_ERR_RECORD_STR_SIZE - 1);
+    if (str == NULL)
+        str = "(null)";
+    while ((len < avail - 1) && ((max < 0) || (len < (unsigned) max)) &&
+           (str[len] != 0))
+        len++;
+
+    ret = rec->strUsed;
+    memcpy(rec->strings + ret, str, len);
+    rec->strings[ret + len] = 0;
+    rec->strUsed += len + 1;
+
+    return(ret);
+}
+
+/**
+ * Record an error without formatting the message. The arguments
+ * are stored by value. Strings, including the file name, are
+ * copied and truncated to fit the record. Messages with unusual
+ * format strings are formatted right away.
+ *
+ * @param rec  the record
+ * @param domain  the domain for the error
+ * @param code  the code for the error
+ * @param level  the error level
+ * @param file  the file source of the error (or NULL)
+ * @param line  the line of the error or 0 if N/A
+ * @param col  column number of the error or 0 if N/A
+ * @param int1  extra int info
+ * @param fmt  printf-like format string
+ * @param ap  arguments to format
+ */
+void
+xmlErrorRecordInit(xmlErrorRecord *rec, int domain, int code,
+                   xmlErrorLevel level, const char *file, int line,
+                   int col, int int1, const char *fmt, va_list ap) {
+    xmlErrorSpec spec;
+    const char *cur;
+    va_list copy;
+    int n = 0;
+
+    rec->domain = domain;
+    rec->code = code;
+    rec->level = level;
+    rec->line = line;
+    rec->col = col;
+    rec->int1 = int1;
+    rec->strUsed = 0;
+    rec->nbArgs = 0;
+    rec->file = -1;
+    if (file != NULL)
+        rec->file = xmlErrorRecordString(rec, file, -1);
+
+    if (fmt == NULL)
+        fmt = "No error message provided";
+    rec->fmt = fmt;
+
+    va_copy(copy, ap);
+
+    for (cur = fmt; *cur != 0; cur++) {
+        int i;
+
+        if (*cur != '%')
+            continue;
+        if (xmlErrorParseSpec(cur, &spec) < 0)
+            goto format;
+        cur = spec.end - 1;
+        if (spec.conv == '%')
+            continue;
+        if (n + spec.stars + 1 > XML_ERR_RECORD_MAX_ARGS)
+            goto format;
+
+        for (i = 0; i < spec.stars; i++)
+            rec->args[n++].i = va_arg(ap, int);
+
+        switch (spec.conv) {
+            case 'd': case 'i':
+                if (spec.longs == 2)
+                    rec->args[n].i = va_arg(ap, long long);
+                else if (spec.longs == 1)
+                    rec->args[n].i = va_arg(ap, long);
+                else if (spec.length == 'z')
+                    rec->args[n].i = va_arg(ap, ptrdiff_t);
+                else
+                    rec->args[n].i = va_arg(ap, int);
+                break;
+
+            case 'u': case 'o': case 'x': case 'X':
+                if (spec.longs == 2)
+                    rec->args[n].u = va_arg(ap, unsigned long long);
+                else if (spec.longs == 1)
+                    rec->args[n].u = va_arg(ap, unsigned long);
+                else if (spec.length == 'z')
+                    rec->args[n].u = va_arg(ap, size_t);
+                else
+                    rec->args[n].u = va_arg(ap, unsigned);
+                break;
+
+            case 'c':
+                rec->args[n].i = va_arg(ap, int);
+                break;
+
+            case 's': {
+                int max = spec.precision;
+
+                /* Precision given as argument */
+                if (max == -2)
+                    max = rec->args[n - 1].i;
+                rec->args[n].i =
+                    xmlErrorRecordString(rec, va_arg(ap, const char *), max);
+                break;
+            }
+
+            case 'p':
+                rec->args[n].p = va_arg(ap, void *);
+                break;
+
+            default:
+                rec->args[n].d = va_arg(ap, double);
+                break;
+        }
+
+        n++;
+    }
+
+    rec->nbArgs = n;
+    va_end(copy);
+    return;
+
+format:
+    /* Store the formatted message instead. */
+    n = rec->strUsed;
+    if (n < XML_ERR_RECORD_STR_SIZE) {
+        vsnprintf(rec->strings + n, XML_ERR_RECORD_STR_SIZE - n, fmt, copy);
+        rec->strUsed = XML_ERR_RECORD_STR_SIZE;
+    } else {
+        n = XML_ERR_RECORD_STR_SIZE - 1;
+    }
+    rec->fmt = NULL;
+    rec->args[0].i = n;
+    va_end(copy);
+}
+
+typedef struct {
+    char *mem;
+    size_t len;
+    size_t cap;
+    int error;
+} xmlErrorBuf;
+
+static void LIBXML_ATTR_FORMAT(2,3)
+xmlErrorBufPrintf(xmlErrorBuf *buf, const char *fmt, ...) {
+    va_list ap;
+    int res;
+
+    if (buf->error)
+        return;
+
+    va_start(ap, fmt);
+    res = vsnprintf(buf->mem + buf->len, buf->cap - buf->len, fmt, ap);
+    va_end(ap);
+    if (res < 0)
+        return;
+
+    if ((size_t) res >= buf->cap - buf->len) {
+        size_t cap = buf->len + res + 1;
+        char *mem;
+
+        if (cap > MAX_ERR_MSG_SIZE) {
+            /* Keep the truncated output. */
+            buf->len = buf->cap - 1;
+            return;
+        }
+        if (cap < 2 * buf->cap)
+            cap = 2 * buf->cap;
+        if (cap > MAX_ERR_MSG_SIZE)
+            cap = MAX_ERR_MSG_SIZE;
+        mem = xmlRealloc(buf->mem, cap);
+        if (mem == NULL) {
+            buf->error = 1;
+            return;
+        }
+        buf->mem = mem;
+        buf->cap = cap;
+
+        va_start(ap, fmt);
+        vsnprintf(buf->mem + buf->len, buf->cap - buf->len, fmt, ap);
+        va_end(ap);
+    }
+
+    buf->len += res;
+}
+
+/**
+ * Format the message of a recorded error.
+ *
+ * @param rec  the record
+ * @returns the message which must be freed or NULL if a memory
+ * allocation failed.
+ */
+char *
+xmlErrorRecordFormat(const xmlErrorRecord *rec) {
+    xmlErrorBuf buf;
+    xmlErrorSpec spec;
+    const char *cur;
+    int n = 0;
+
+    if (rec->fmt == NULL)
+        return(xmlMemStrdup(rec->strings + rec->args[0].i));
+
+    buf.cap = 100;
+    buf.len = 0;
+    buf.error = 0;
+    buf.mem = xmlMalloc(buf.cap);
+    if (buf.mem == NULL)
+        return(NULL);
+    buf.mem[0] = 0;
+
+    cur = rec->fmt;
+    while (*cur != 0) {
+        char specBuf[64];
+        const char *p;
+        int len = 0;
+
+        if (*cur != '%') {
+            p = cur;
+            while ((*cur != 0) && (*cur != '%'))
+                cur++;
+            xmlErrorBufPrintf(&buf, "%.*s", (int) (cur - p), p);
+            continue;
+        }
+
+        xmlErrorParseSpec(cur, &spec);
+        if (spec.conv == '%') {
+            xmlErrorBufPrintf(&buf, "%%");
+            cur = spec.end;
+            continue;
+        }
+
+        /*
+         * Rebuild the specification with stars replaced and without
+         * length modifiers.
+         */
+        for (p = cur; p < spec.end - 1; p++) {
+            if (len > (int) sizeof(specBuf) - 16)
+                break;
+            if (*p == '*') {
+                int val = rec->args[n++].i;
+
+                if ((p[-1] == '.') && (val < 0))
+                    len--;
+                else
+                    len += snprintf(specBuf + len, 12, "%d", val);
+            } else if ((*p != 'l') && (*p != 'h') && (*p != 'z')) {
+                specBuf[len++] = *p;
+            }
+        }
+
+        switch (spec.conv) {
+            case 'd': case 'i':
+                specBuf[len++] = 'l';
+                specBuf[len++] = 'l';
+                specBuf[len++] = spec.conv;
+                specBuf[len] = 0;
+                xmlErrorBufPrintf(&buf, specBuf, rec->args[n].i);
+                break;
+            case 'u': case 'o': case 'x': case 'X':
+                specBuf[len++] = 'l';
+                specBuf[len++] = 'l';
+                specBuf[len++] = spec.conv;
+                specBuf[len] = 0;
+                xmlErrorBufPrintf(&buf, specBuf, rec->args[n].u);
+                break;
+            case 'c':
+                specBuf[len++] = spec.conv;
+                specBuf[len] = 0;
+                xmlErrorBufPrintf(&buf, specBuf, (int) rec->args[n].i);
+                break;
+            case 's':
+                specBuf[len++] = spec.conv;
+                specBuf[len] = 0;
+                xmlErrorBufPrintf(&buf, specBuf,
+                                  rec->strings + rec->args[n].i);
+                break;
+            case 'p':
+                specBuf[len++] = spec.conv;
+                specBuf[len] = 0;
+                xmlErrorBufPrintf(&buf, specBuf, rec->args[n].p);
+                break;
+            default:
+                specBuf[len++] = spec.conv;
+                specBuf[len] = 0;
+                xmlErrorBufPrintf(&buf, specBuf, rec->args[n].d);
+                break;
+        }
+
+        n++;
+        cur = spec.end;
+    }
+
+    if (buf.error) {
+        xmlFree(buf.mem);
+        return(NULL);
+    }
+
+    return(buf.mem);
+}
+
+/**
+ * Fill an error struct with the formatted contents of a record.
+ *
+ * @param rec  the record
+ * @param ctxt  the parser context or NULL
+ * @param err  the error struct
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+int
+xmlErrorRecordToError(const xmlErrorRecord *rec, void *ctxt,
+                      xmlError *err) {
+    char *message;
+    int res;
+
+    message = xmlErrorRecordFormat(rec);
+    if (message == NULL)
+        return(-1);
+
+    res = xmlSetError(err, ctxt, NULL, rec->domain, rec->code, rec->level,
+                      rec->file >= 0 ? rec->strings + rec->file : NULL,
+                      rec->line, NULL, NULL, NULL, rec->int1, rec->col,
+                      "%s", message);
+    xmlFree(message);
+
+    return(res);
+}
+
+/**
+ * Update the global and contextual error structure without
+ * formatting a message or copying strings, then forward the error
+ * to a structured error handler.
+ *
+ * The message, file and string fields of the error are NULL.
+ * Legacy error handlers are never invoked.
+ *
+ * @param schannel  the structured callback channel
+ * @param data  the callback data
+ * @param ctxt  the parser context or NULL
+ * @param node  the node or NULL
+ * @param domain  the domain for the error
+ * @param code  the code for the error
+ * @param level  the xmlErrorLevel for the error
+ * @param line  the line of the error or 0 if N/A
+ * @param int1  extra int info
+ * @param col  column number of the error or 0 if N/A
+ * @param to  the contextual error struct or NULL
+ */
+void
+xmlRaiseDeferredError(xmlStructuredErrorFunc schannel, void *data,
+                      void *ctxt, xmlNode *node, int domain, int code,
+                      xmlErrorLevel level, int line, int int1, int col,
+                      xmlError *to) {
+    xmlErrorPtr lastError = xmlGetLastErrorInternal();
+
+    if (code == XML_ERR_OK)
+        return;
+    if ((xmlGetWarningsDefaultValue == 0) && (level == XML_ERR_WARNING))
+        return;
+
+    xmlErrorNodeInfo(&node, NULL, &line);
+
+    if (to == NULL)
+        to = lastError;
+    xmlResetError(to);
+    to->domain = domain;
+    to->code = code;
+    to->level = level;
+    to->line = line;
+    to->int1 = int1;
+    to->int2 = col;
+    to->node = node;
+    to->ctxt = ctxt;
+
+    if (to != lastError) {
+        xmlResetError(lastError);
+        memcpy(lastError, to, sizeof(*to));
+    }
+
+    if (schannel != NULL)
+	schannel(data, to);
+    else if (xmlStructuredError != NULL)
+        xmlStructuredError(xmlStructuredErrorContext, to);
+}
+
+/************************************************************************
+ *									*
+ *			Error policies					*
+ *									*
+ ************************************************************************/
+
+/* Slot for the total count of a code */
+#define XML_ERR_POLICY_ALL 31
+
+/**
+ * Create, update or remove the error policy of a context.
+ *
+ * @param policy  pointer to the policy of a context
+ * @param maxErrors  stop after this number of errors or 0
+ * @param maxPerCode  report at most this number of errors per code or 0
+ * @param dedup  report errors only once per code and node type
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+int
+xmlErrorPolicySet(xmlErrorPolicy **policy, int maxErrors, int maxPerCode,
+                  int dedup) {
+    xmlErrorPolicy *pol = *policy;
+
+    if (maxErrors < 0)
+        maxErrors = 0;
+    if (maxPerCode < 0)
+        maxPerCode = 0;
+
+    if ((maxErrors == 0) && (maxPerCode == 0) && (!dedup)) {
+        xmlErrorPolicyFree(pol);
+        *policy = NULL;
+        return(0);
+    }
+
+    if (pol == NULL) {
+        pol = xmlMalloc(sizeof(*pol));
+        if (pol == NULL)
+            return(-1);
+        memset(pol, 0, sizeof(*pol));
+        *policy = pol;
+    }
+    pol->maxErrors = maxErrors;
+    pol->maxPerCode = maxPerCode;
+    pol->dedup = dedup ? 1 : 0;
+
+    return(0);
+}
+
+/**
+ * Free an error policy.
+ *
+ * @param policy  the policy (optional)
+ */
+void
+xmlErrorPolicyFree(xmlErrorPolicy *policy) {
+    if (policy == NULL)
+        return;
+    xmlFree(policy->keys);
+    xmlFree(policy->counts);
+    xmlFree(policy);
+}
+
+/**
+ * Clear counts before a new run.
+ *
+ * @param policy  the policy (optional)
+ */
+void
+xmlErrorPolicyReset(xmlErrorPolicy *policy) {
+    if (policy == NULL)
+        return;
+    if (policy->used > 0)
+        memset(policy->keys, 0, policy->size * sizeof(policy->keys[0]));
+    policy->used = 0;
+    policy->nbErrors = 0;
+    policy->stopped = 0;
+}
+
+static unsigned
+xmlErrorPolicyFind(const xmlErrorPolicy *policy, unsigned key) {
+    unsigned mask = policy->size - 1;
+    unsigned i = (key * 0x9E3779B1u) & mask;
+
+    while ((policy->keys[i] != 0) && (policy->keys[i] != key))
+        i = (i + 1) & mask;
+
+    return(i);
+}
+
+/**
+ * Increment the count of a key.
+ *
+ * @returns the new count or 0 if a memory allocation failed.
+ */
+static unsigned
+xmlErrorPolicyIncrement(xmlErrorPolicy *policy, unsigned key) {
+    unsigned i;
+
+    if (2 * (policy->used + 1) > policy->size) {
+        unsigned *keys, *counts;
+        unsigned size = policy->size ? 2 * policy->size : 32;
+        unsigned j;
+
+        keys = xmlMalloc(size * sizeof(keys[0]));
+        counts = xmlMalloc(size * sizeof(counts[0]));
+        if ((keys == NULL) || (counts == NULL)) {
+            xmlFree(keys);
+            xmlFree(counts);
+            return(0);
+        }
+        memset(keys, 0, size * sizeof(keys[0]));
+
+        for (j = 0; j < policy->size; j++) {
+            unsigned mask = size - 1;
+
+            if (policy->keys[j] == 0)
+                continue;
+            i = (policy->keys[j] * 0x9E3779B1u) & mask;
+            while (keys[i] != 0)
+                i = (i + 1) & mask;
+            keys[i] = policy->keys[j];
+            counts[i] = policy->counts[j];
+        }
+
+        xmlFree(policy->keys);
+        xmlFree(policy->counts);
+        policy->keys = keys;
+        policy->counts = counts;
+        policy->size = size;
+    }
+
+    i = xmlErrorPolicyFind(policy, key);
+    if (policy->keys[i] == 0) {
+        policy->keys[i] = key;
+        policy->counts[i] = 0;
+        policy->used += 1;
+    }
+    if (policy->counts[i] < UINT_MAX)
+        policy->counts[i] += 1;
+
+    return(policy->counts[i]);
+}
+
+/**
+ * Count an error and decide whether it should be reported.
+ *
+ * Errors which can't be counted because a memory allocation failed
+ * are reported.
+ *
+ * @param policy  the policy
+ * @param code  the error code
+ * @param nodeType  type of the node or 0
+ * @param level  the error level
+ * @returns 1 if the error should be reported, 0 otherwise.
+ */
+int
+xmlErrorPolicyCheck(xmlErrorPolicy *policy, int code, int nodeType,
+                    xmlErrorLevel level) {
+    unsigned key = (unsigned) code << 5;
+    unsigned total, count;
+    int report = 1;
+
+    if (policy->stopped)
+        return(0);
+
+    if ((nodeType < 0) || (nodeType >= XML_ERR_POLICY_ALL))
+        nodeType = 0;
+
+    total = xmlErrorPolicyIncrement(policy, key | XML_ERR_POLICY_ALL);
+    count = xmlErrorPolicyIncrement(policy, key | nodeType);
+
+    if ((policy->dedup) && (count > 1))
+        report = 0;
+    if ((policy->maxPerCode > 0) && (total > (unsigned) policy->maxPerCode))
+        report = 0;
+
+    if (level >= XML_ERR_ERROR) {
+        policy->nbErrors += 1;
+        if ((policy->maxErrors > 0) &&
+            (policy->nbErrors >= policy->maxErrors))
+            policy->stopped = 1;
+    }
+
+    return(report);
+}
+
+/**
+ * @param policy  the policy (optional)
+ * @param code  the error code
+ * @param nodeType  type of the node, 0 for errors without node or -1
+ * for all node types
+ * @returns the number of errors with this code since the last reset.
+ */
+int
+xmlErrorPolicyCount(const xmlErrorPolicy *policy, int code, int nodeType) {
+    unsigned key = (unsigned) code << 5;
+    unsigned i;
+
+    if ((policy == NULL) || (policy->used == 0))
+        return(0);
+    if (nodeType < 0)
+        key |= XML_ERR_POLICY_ALL;
+    else if (nodeType < XML_ERR_POLICY_ALL)
+        key |= nodeType;
+    else
+        return(0);
+
+    i = xmlErrorPolicyFind(policy, key);
+    if (policy->keys[i] == 0)
+        return(0);
+    return(policy->counts[i] > INT_MAX ? INT_MAX : (int) policy->counts[i]);
+}
+
 static void
 xmlVFormatLegacyError(void *ctx, const char *level,
                       const char *fmt, va_list ap) {
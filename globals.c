@@ -25,8 +25,10 @@
 #include "private/dict.h"
 #include "private/error.h"
 #include "private/globals.h"
+#include "private/memory.h"
 #include "private/threads.h"
 #include "private/tree.h"
+#include "private/xpath.h"
 
 /*
  * Mutex to protect "ForNewThreads" variables
@@ -136,6 +138,12 @@ struct _xmlGlobalState {
 
     xmlError lastError;
 
+    xmlPoolCache poolCache;
+
+#ifdef LIBXML_XPATH_ENABLED
+    void *xpathCache;
+#endif
+
 #ifdef LIBXML_THREAD_ALLOC_ENABLED
     xmlMallocFunc malloc;
     xmlMallocFunc mallocAtomic;
@@ -406,6 +414,11 @@ void xmlCleanupGlobalsInternal(void) {
 #endif
 #else /* no thread support */
     xmlResetError(&globalState.lastError);
+#ifdef LIBXML_XPATH_ENABLED
+    xmlXPathFreeThreadCache(globalState.xpathCache);
+    globalState.xpathCache = NULL;
+#endif
+    xmlPoolCacheRelease(&globalState.poolCache);
 #endif
 
     xmlCleanupMutex(&xmlThrDefMutex);
@@ -424,6 +437,11 @@ xmlFreeGlobalState(void *state)
      * a destructor with thread-local storage at all!
      */
     xmlResetError(&gs->lastError);
+#ifdef LIBXML_XPATH_ENABLED
+    xmlXPathFreeThreadCache(gs->xpathCache);
+    gs->xpathCache = NULL;
+#endif
+    xmlPoolCacheRelease(&gs->poolCache);
 #ifndef USE_TLS
     free(state);
 #endif
@@ -542,6 +560,10 @@ xmlInitGlobalState(xmlGlobalStatePtr gs) {
 
     memset(&gs->lastError, 0, sizeof(xmlError));
 
+#ifdef LIBXML_XPATH_ENABLED
+    gs->xpathCache = NULL;
+#endif
+
 #ifdef LIBXML_THREAD_ALLOC_ENABLED
     /* XML_GLOBALS_ALLOC */
     gs->free = free;
@@ -734,6 +756,24 @@ xmlGetLocalRngState(void) {
     return(xmlGetThreadLocalStorage(0)->localRngState);
 }
 
+/**
+ * @returns the pool allocator state of the current thread.
+ */
+xmlPoolCache *
+xmlGetLocalPoolCache(void) {
+    return(&xmlGetThreadLocalStorage(0)->poolCache);
+}
+
+#ifdef LIBXML_XPATH_ENABLED
+/**
+ * @returns the slot for the XPath object cache of the current thread.
+ */
+void **
+xmlGetLocalXPathCache(void) {
+    return(&xmlGetThreadLocalStorage(0)->xpathCache);
+}
+#endif
+
 /**
  * Check whether thread-local storage could be allocated.
  *
@@ -2,7 +2,8 @@
  * hash.c: hash tables
  *
  * Hash table with open addressing, linear probing and
- * Robin Hood reordering.
+ * Robin Hood reordering. Lookups are accelerated with a parallel
+ * array of one-byte tags which is probed a group at a time.
  *
  * See Copyright for the status of this software.
  */
@@ -10,6 +11,7 @@
 #define IN_LIBXML
 #include "libxml.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
@@ -20,6 +22,15 @@
 #include <libxml/xmlstring.h>
 
 #include "private/dict.h"
+#include "private/hash.h"
+#include "private/simd.h"
+
+#ifdef XML_SIMD_SSE2
+  #include <emmintrin.h>
+#endif
+#ifdef XML_SIMD_NEON
+  #include <arm_neon.h>
+#endif
 
 #ifndef SIZE_MAX
   #define SIZE_MAX ((size_t) -1)
@@ -30,6 +41,18 @@
 #define MIN_HASH_SIZE 8
 #define MAX_HASH_SIZE (1u << 31)
 
+/*
+ * Number of tags compared at once when probing
+ */
+#define HASH_GROUP_SIZE 16
+
+/*
+ * The tag of an entry is the top byte of its hash value. Since the
+ * MAX_HASH_SIZE bit is always set, it's never zero which marks empty
+ * slots.
+ */
+#define HASH_TAG(hashValue) ((unsigned char) ((hashValue) >> 24))
+
 /*
  * A single entry in the hash table
  */
@@ -42,15 +65,43 @@ typedef struct {
     void *payload;
 } xmlHashEntry;
 
+/*
+ * An entry of the index of dict-owned keys
+ */
+typedef struct {
+    const xmlChar *key; /* NULL means unoccupied */
+    const xmlChar *key2;
+    const xmlChar *key3;
+    void *payload;
+} xmlHashPtrEntry;
+
+/*
+ * Index of the entries of a dict-backed table by key pointers, see
+ * xmlHashIndexInterned. Uses linear probing with backward shift
+ * deletion and a fill factor of at most 1/2.
+ */
+typedef struct {
+    xmlHashPtrEntry *table;
+    unsigned size; /* power of two */
+    unsigned nbElems;
+} xmlHashPtrIndex;
+
 /*
  * The entire hash table
  */
 struct _xmlHashTable {
     xmlHashEntry *table;
+    /*
+     * Tags of the entries in the table followed by a copy of the first
+     * HASH_GROUP_SIZE - 1 tags, so that a full group can be loaded
+     * at every position without wrapping.
+     */
+    unsigned char *tags;
     unsigned size; /* power of two */
     unsigned nbElems;
     xmlDictPtr dict;
     unsigned randomSeed;
+    xmlHashPtrIndex *ptrIndex;
 };
 
 static int
@@ -60,40 +111,32 @@ ATTRIBUTE_NO_SANITIZE_INTEGER
 static unsigned
 xmlHashValue(unsigned seed, const xmlChar *key, const xmlChar *key2,
              const xmlChar *key3, size_t *lengths) {
-    unsigned h1, h2;
-    size_t i;
+    xmlHashState st;
+    size_t len;
 
-    HASH_INIT(h1, h2, seed);
+    xmlHashInit(&st, seed);
 
-    for (i = 0; key[i] != 0; i++) {
-        HASH_UPDATE(h1, h2, key[i]);
-    }
+    len = xmlHashUpdateString(&st, key, SIZE_MAX);
     if (lengths)
-        lengths[0] = i;
+        lengths[0] = len;
 
-    HASH_UPDATE(h1, h2, 0);
+    xmlHashUpdateByte(&st, 0);
 
     if (key2 != NULL) {
-        for (i = 0; key2[i] != 0; i++) {
-            HASH_UPDATE(h1, h2, key2[i]);
-        }
+        len = xmlHashUpdateString(&st, key2, SIZE_MAX);
         if (lengths)
-            lengths[1] = i;
+            lengths[1] = len;
     }
 
-    HASH_UPDATE(h1, h2, 0);
+    xmlHashUpdateByte(&st, 0);
 
     if (key3 != NULL) {
-        for (i = 0; key3[i] != 0; i++) {
-            HASH_UPDATE(h1, h2, key3[i]);
-        }
+        len = xmlHashUpdateString(&st, key3, SIZE_MAX);
         if (lengths)
-            lengths[2] = i;
+            lengths[2] = len;
     }
 
-    HASH_FINISH(h1, h2);
-
-    return(h2);
+    return(xmlHashFinish(&st));
 }
 
 ATTRIBUTE_NO_SANITIZE_INTEGER
@@ -102,49 +145,32 @@ xmlHashQNameValue(unsigned seed,
                   const xmlChar *prefix, const xmlChar *name,
                   const xmlChar *prefix2, const xmlChar *name2,
                   const xmlChar *prefix3, const xmlChar *name3) {
-    unsigned h1, h2, ch;
+    xmlHashState st;
 
-    HASH_INIT(h1, h2, seed);
+    xmlHashInit(&st, seed);
 
     if (prefix != NULL) {
-        while ((ch = *prefix++) != 0) {
-            HASH_UPDATE(h1, h2, ch);
-        }
-        HASH_UPDATE(h1, h2, ':');
+        xmlHashUpdateString(&st, prefix, SIZE_MAX);
+        xmlHashUpdateByte(&st, ':');
     }
-    if (name != NULL) {
-        while ((ch = *name++) != 0) {
-            HASH_UPDATE(h1, h2, ch);
-        }
-    }
-    HASH_UPDATE(h1, h2, 0);
+    if (name != NULL)
+        xmlHashUpdateString(&st, name, SIZE_MAX);
+    xmlHashUpdateByte(&st, 0);
     if (prefix2 != NULL) {
-        while ((ch = *prefix2++) != 0) {
-            HASH_UPDATE(h1, h2, ch);
-        }
-        HASH_UPDATE(h1, h2, ':');
+        xmlHashUpdateString(&st, prefix2, SIZE_MAX);
+        xmlHashUpdateByte(&st, ':');
     }
-    if (name2 != NULL) {
-        while ((ch = *name2++) != 0) {
-            HASH_UPDATE(h1, h2, ch);
-        }
-    }
-    HASH_UPDATE(h1, h2, 0);
+    if (name2 != NULL)
+        xmlHashUpdateString(&st, name2, SIZE_MAX);
+    xmlHashUpdateByte(&st, 0);
     if (prefix3 != NULL) {
-        while ((ch = *prefix3++) != 0) {
-            HASH_UPDATE(h1, h2, ch);
-        }
-        HASH_UPDATE(h1, h2, ':');
+        xmlHashUpdateString(&st, prefix3, SIZE_MAX);
+        xmlHashUpdateByte(&st, ':');
     }
-    if (name3 != NULL) {
-        while ((ch = *name3++) != 0) {
-            HASH_UPDATE(h1, h2, ch);
-        }
-    }
-
-    HASH_FINISH(h1, h2);
+    if (name3 != NULL)
+        xmlHashUpdateString(&st, name3, SIZE_MAX);
 
-    return(h2);
+    return(xmlHashFinish(&st));
 }
 
 /**
@@ -166,7 +192,9 @@ xmlHashCreate(int size) {
     hash->dict = NULL;
     hash->size = 0;
     hash->table = NULL;
+    hash->tags = NULL;
     hash->nbElems = 0;
+    hash->ptrIndex = NULL;
     hash->randomSeed = xmlRandom();
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
     hash->randomSeed = 0;
@@ -178,12 +206,7 @@ xmlHashCreate(int size) {
      * hash tables which are never filled.
      */
     if (size > MIN_HASH_SIZE) {
-        unsigned newSize = MIN_HASH_SIZE * 2;
-
-        while ((newSize < (unsigned) size) && (newSize < MAX_HASH_SIZE))
-            newSize *= 2;
-
-        if (xmlHashGrow(hash, newSize) != 0) {
+        if (xmlHashReserve(hash, size) != 0) {
             xmlFree(hash);
             return(NULL);
         }
@@ -213,6 +236,267 @@ xmlHashCreateDict(int size, xmlDict *dict) {
     return(hash);
 }
 
+/*
+ * Hash the key pointers of an entry
+ */
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static unsigned
+xmlHashPtrValue(const xmlChar *key, const xmlChar *key2,
+                const xmlChar *key3) {
+    unsigned long long h;
+
+    h = (unsigned long long) (size_t) key * 0x9E3779B97F4A7C15ULL;
+    h ^= (unsigned long long) (size_t) key2;
+    h *= 0xC2B2AE3D27D4EB4FULL;
+    h ^= (unsigned long long) (size_t) key3;
+    h *= 0x9E3779B97F4A7C15ULL;
+
+    return((unsigned) (h >> 32));
+}
+
+/**
+ * Find the entry with the given key pointers in the pointer index or
+ * the empty slot where it would be inserted.
+ *
+ * @param index  pointer index, size > 0
+ * @param key  first key
+ * @param key2  second key
+ * @param key3  third key
+ * @returns the entry
+ */
+static xmlHashPtrEntry *
+xmlHashPtrFind(const xmlHashPtrIndex *index, const xmlChar *key,
+               const xmlChar *key2, const xmlChar *key3) {
+    unsigned mask = index->size - 1;
+    unsigned pos = xmlHashPtrValue(key, key2, key3) & mask;
+    xmlHashPtrEntry *entry;
+
+    while (1) {
+        entry = &index->table[pos];
+        if ((entry->key == NULL) ||
+            ((entry->key == key) &&
+             (entry->key2 == key2) &&
+             (entry->key3 == key3)))
+            return(entry);
+        pos = (pos + 1) & mask;
+    }
+}
+
+/**
+ * Resize the pointer index.
+ *
+ * @param index  pointer index
+ * @param size  new size, a power of two
+ * @returns 0 in case of success, -1 if a memory allocation failed.
+ */
+static int
+xmlHashPtrGrow(xmlHashPtrIndex *index, unsigned size) {
+    xmlHashPtrEntry *oldTable = index->table;
+    unsigned oldSize = index->size;
+    unsigned i;
+
+    index->table = xmlMalloc(size * sizeof(index->table[0]));
+    if (index->table == NULL) {
+        index->table = oldTable;
+        return(-1);
+    }
+    memset(index->table, 0, size * sizeof(index->table[0]));
+    index->size = size;
+
+    for (i = 0; i < oldSize; i++) {
+        const xmlHashPtrEntry *old = &oldTable[i];
+
+        if (old->key != NULL)
+            *xmlHashPtrFind(index, old->key, old->key2, old->key3) = *old;
+    }
+    xmlFree(oldTable);
+
+    return(0);
+}
+
+/**
+ * Free the pointer index of a hash table. Lookups of interned keys
+ * fall back to hashing the strings afterwards.
+ *
+ * @param hash  hash table
+ */
+static void
+xmlHashPtrDrop(xmlHashTablePtr hash) {
+    if (hash->ptrIndex == NULL)
+        return;
+    xmlFree(hash->ptrIndex->table);
+    xmlFree(hash->ptrIndex);
+    hash->ptrIndex = NULL;
+}
+
+/**
+ * Add or update an entry of the pointer index. If memory runs out,
+ * the index is dropped.
+ *
+ * @param hash  hash table
+ * @param key  first key, owned by the table
+ * @param key2  second key, owned by the table
+ * @param key3  third key, owned by the table
+ * @param payload  the payload
+ */
+static void
+xmlHashPtrSet(xmlHashTablePtr hash, const xmlChar *key,
+              const xmlChar *key2, const xmlChar *key3, void *payload) {
+    xmlHashPtrIndex *index = hash->ptrIndex;
+    xmlHashPtrEntry *entry;
+
+    if (index == NULL)
+        return;
+
+    entry = xmlHashPtrFind(index, key, key2, key3);
+    if (entry->key == NULL) {
+        if (index->nbElems + 1 > index->size / 2) {
+            if ((index->size >= MAX_HASH_SIZE) ||
+                (xmlHashPtrGrow(index, index->size * 2) != 0)) {
+                xmlHashPtrDrop(hash);
+                return;
+            }
+            entry = xmlHashPtrFind(index, key, key2, key3);
+        }
+        entry->key = key;
+        entry->key2 = key2;
+        entry->key3 = key3;
+        index->nbElems++;
+    }
+    entry->payload = payload;
+}
+
+/**
+ * Remove an entry from the pointer index.
+ *
+ * @param hash  hash table
+ * @param key  first key, owned by the table
+ * @param key2  second key, owned by the table
+ * @param key3  third key, owned by the table
+ */
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static void
+xmlHashPtrRemove(xmlHashTablePtr hash, const xmlChar *key,
+                 const xmlChar *key2, const xmlChar *key3) {
+    xmlHashPtrIndex *index = hash->ptrIndex;
+    xmlHashPtrEntry *entry;
+    unsigned mask, hole, pos, home;
+
+    if (index == NULL)
+        return;
+
+    entry = xmlHashPtrFind(index, key, key2, key3);
+    if (entry->key == NULL)
+        return;
+
+    /*
+     * Move following entries of the cluster into the hole unless
+     * their home position lies between the hole and themselves.
+     */
+    mask = index->size - 1;
+    hole = entry - index->table;
+    pos = hole;
+    while (1) {
+        pos = (pos + 1) & mask;
+        entry = &index->table[pos];
+        if (entry->key == NULL)
+            break;
+        home = xmlHashPtrValue(entry->key, entry->key2, entry->key3) & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+            index->table[hole] = *entry;
+            hole = pos;
+        }
+    }
+    index->table[hole].key = NULL;
+    index->nbElems--;
+}
+
+/**
+ * Build an index of the entries of a dict-backed hash table by the
+ * addresses of their keys. Lookups with the xmlHashLookupInterned
+ * functions then hash and compare pointers instead of strings when
+ * the keys are owned by the table's dictionary. The index is kept up
+ * to date when entries are added, updated or removed.
+ *
+ * @param hash  hash table created with #xmlHashCreateDict
+ * @returns 0 in case of success, -1 if the table has no dictionary
+ * or a memory allocation failed.
+ */
+int
+xmlHashIndexInterned(xmlHashTable *hash) {
+    xmlHashPtrIndex *index;
+    unsigned size = MIN_HASH_SIZE;
+    unsigned i;
+
+    if ((hash == NULL) || (hash->dict == NULL))
+        return(-1);
+    if (hash->ptrIndex != NULL)
+        return(0);
+
+    while ((size / 2 < hash->nbElems + 1) && (size < MAX_HASH_SIZE))
+        size *= 2;
+
+    index = xmlMalloc(sizeof(*index));
+    if (index == NULL)
+        return(-1);
+    index->table = NULL;
+    index->size = 0;
+    index->nbElems = 0;
+    if (xmlHashPtrGrow(index, size) != 0) {
+        xmlFree(index);
+        return(-1);
+    }
+    hash->ptrIndex = index;
+
+    for (i = 0; i < hash->size; i++) {
+        const xmlHashEntry *entry = &hash->table[i];
+
+        if (entry->hashValue != 0)
+            xmlHashPtrSet(hash, entry->key, entry->key2, entry->key3,
+                          entry->payload);
+    }
+
+    return(hash->ptrIndex != NULL ? 0 : -1);
+}
+
+/**
+ * Make room for `size` entries in a hash table, so that adding that
+ * many entries doesn't rehash the table repeatedly.
+ *
+ * @since 2.16.0
+ *
+ * @param hash  hash table
+ * @param size  the total number of entries
+ * @returns 0 in case of success, -1 if the arguments are invalid or
+ * a memory allocation failed.
+ */
+int
+xmlHashReserve(xmlHashTable *hash, int size) {
+    unsigned newSize = MIN_HASH_SIZE;
+
+    if ((hash == NULL) || (size < 0) ||
+        ((unsigned) size > MAX_HASH_SIZE / MAX_FILL_DENOM * MAX_FILL_NUM))
+        return(-1);
+
+    while ((unsigned) size > newSize / MAX_FILL_DENOM * MAX_FILL_NUM)
+        newSize *= 2;
+    if ((newSize > hash->size) && (xmlHashGrow(hash, newSize) != 0))
+        return(-1);
+
+    if (hash->ptrIndex != NULL) {
+        xmlHashPtrIndex *index = hash->ptrIndex;
+
+        newSize = MIN_HASH_SIZE;
+        while ((newSize / 2 < (unsigned) size) && (newSize < MAX_HASH_SIZE))
+            newSize *= 2;
+        if ((newSize > index->size) &&
+            (xmlHashPtrGrow(index, newSize) != 0))
+            xmlHashPtrDrop(hash);
+    }
+
+    return(0);
+}
+
 /**
  * Free the hash and its contents. The payload is deallocated with
  * `dealloc` if provided.
@@ -245,10 +529,12 @@ xmlHashFree(xmlHashTable *hash, xmlHashDeallocator dealloc) {
         }
 
         xmlFree(hash->table);
+        xmlFree(hash->tags);
     }
 
     if (hash->dict)
         xmlDictFree(hash->dict);
+    xmlHashPtrDrop(hash);
 
     xmlFree(hash);
 }
@@ -268,6 +554,138 @@ xmlFastStrEqual(const xmlChar *s1, const xmlChar *s2) {
                (strcmp((const char *) s1, (const char *) s2) == 0));
 }
 
+/**
+ * Compare the keys of an entry.
+ *
+ * @param hash  hash table
+ * @param entry  hash table entry
+ * @param key  first string key, non-NULL
+ * @param key2  second string key
+ * @param key3  third string key
+ * @returns 1 if the keys match, 0 otherwise.
+ */
+static XML_INLINE int
+xmlHashEntryEqual(const xmlHashTable *hash, const xmlHashEntry *entry,
+                  const xmlChar *key, const xmlChar *key2,
+                  const xmlChar *key3) {
+    if ((hash->dict) &&
+        (entry->key == key) &&
+        (entry->key2 == key2) &&
+        (entry->key3 == key3))
+        return(1);
+
+    return((strcmp((const char *) entry->key, (const char *) key) == 0) &&
+           (xmlFastStrEqual(entry->key2, key2)) &&
+           (xmlFastStrEqual(entry->key3, key3)));
+}
+
+/**
+ * Recompute the tags of the entries from `first` to `last`, wrapping
+ * around the end of the table.
+ *
+ * @param hash  hash table, non-NULL, size > 0
+ * @param first  first position
+ * @param last  last position
+ */
+static void
+xmlHashSetTags(xmlHashTablePtr hash, unsigned first, unsigned last) {
+    unsigned mask = hash->size - 1;
+    unsigned end = hash->size + HASH_GROUP_SIZE - 1;
+    unsigned pos = first;
+
+    while (1) {
+        unsigned char tag = HASH_TAG(hash->table[pos].hashValue);
+        unsigned i;
+
+        for (i = pos; i < end; i += hash->size)
+            hash->tags[i] = tag;
+
+        if (pos == last)
+            break;
+        pos = (pos + 1) & mask;
+    }
+}
+
+#if defined(XML_SIMD_NEON)
+  /* One nibble per lane */
+  #define HASH_LANE_SHIFT 2
+#else
+  #define HASH_LANE_SHIFT 0
+#endif
+
+/**
+ * Compare a group of HASH_GROUP_SIZE tags with `tag`.
+ *
+ * @param group  start of the group
+ * @param tag  tag to look for
+ * @param empty  set to a mask of the empty slots in the group
+ * @returns a mask of matching slots. Slot i corresponds to
+ * bit i << HASH_LANE_SHIFT.
+ */
+static XML_INLINE unsigned long long
+xmlHashMatchGroup(const unsigned char *group, unsigned char tag,
+                  unsigned long long *empty) {
+#if defined(XML_SIMD_SSE2)
+    __m128i g = _mm_loadu_si128((const __m128i *) group);
+
+    *empty = (unsigned) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(g, _mm_setzero_si128()));
+    return((unsigned) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(g, _mm_set1_epi8((char) tag))));
+#elif defined(XML_SIMD_NEON)
+    const unsigned long long lanes = 0x8888888888888888ull;
+    uint8x16_t g = vld1q_u8(group);
+    uint8x16_t eq;
+
+    eq = vceqq_u8(g, vdupq_n_u8(0));
+    *empty = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0) & lanes;
+    eq = vceqq_u8(g, vdupq_n_u8(tag));
+    return(vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0) & lanes);
+#else
+    unsigned long long matches = 0;
+    unsigned i;
+
+    *empty = 0;
+    for (i = 0; i < HASH_GROUP_SIZE; i++) {
+        if (group[i] == 0)
+            *empty |= 1ull << i;
+        else if (group[i] == tag)
+            matches |= 1ull << i;
+    }
+    return(matches);
+#endif
+}
+
+/**
+ * Return the candidates in a group matching the tag up to the first
+ * empty slot. Since entries are never separated from their initial
+ * probe position by an empty slot, the search can stop there.
+ *
+ * @param group  start of the group
+ * @param tag  tag to look for
+ * @param last  set to 1 if the group contains an empty slot
+ * @returns a mask of candidate slots
+ */
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE unsigned long long
+xmlHashGroupCandidates(const unsigned char *group, unsigned char tag,
+                       int *last) {
+    unsigned long long matches, empty;
+
+    matches = xmlHashMatchGroup(group, tag, &empty);
+    if (empty != 0) {
+        /* Keep matches below the lowest empty slot */
+        matches &= (empty & (~empty + 1)) - 1;
+        *last = 1;
+    } else {
+        *last = 0;
+    }
+
+    return(matches);
+}
+
 /**
  * Try to find a matching hash table entry. If an entry was found, set
  * `found` to 1 and return the entry. Otherwise, set `found` to 0 and return
@@ -345,6 +763,7 @@ static int
 xmlHashGrow(xmlHashTablePtr hash, unsigned size) {
     const xmlHashEntry *oldentry, *oldend, *end;
     xmlHashEntry *table;
+    unsigned char *tags;
     unsigned oldsize, i;
 
     /* Add 0 to avoid spurious -Wtype-limits warning on 64-bit GCC */
@@ -355,6 +774,12 @@ xmlHashGrow(xmlHashTablePtr hash, unsigned size) {
         return(-1);
     memset(table, 0, size * sizeof(table[0]));
 
+    tags = xmlMalloc(size + HASH_GROUP_SIZE - 1);
+    if (tags == NULL) {
+        xmlFree(table);
+        return(-1);
+    }
+
     oldsize = hash->size;
     if (oldsize == 0)
         goto done;
@@ -391,39 +816,40 @@ xmlHashGrow(xmlHashTablePtr hash, unsigned size) {
     }
 
     xmlFree(hash->table);
+    xmlFree(hash->tags);
 
 done:
     hash->table = table;
+    hash->tags = tags;
     hash->size = size;
 
+    xmlHashSetTags(hash, 0, size - 1);
+
     return(0);
 }
 
 /**
- * Internal function to add or update hash entries.
+ * Add or update a hash entry whose hash value was already computed.
  *
  * @param hash  hash table
  * @param key  first string key
  * @param key2  second string key
  * @param key3  third string key
+ * @param hashValue  hash value of the keys
+ * @param lengths  lengths of the keys
  * @param payload  pointer to the payload
  * @param dealloc  deallocator function for replaced item or NULL
  * @param update  whether existing entries should be updated
  */
 ATTRIBUTE_NO_SANITIZE_INTEGER
 static int
-xmlHashUpdateInternal(xmlHashTable *hash, const xmlChar *key,
-                      const xmlChar *key2, const xmlChar *key3,
-                      void *payload, xmlHashDeallocator dealloc, int update) {
+xmlHashUpdateHashed(xmlHashTable *hash, const xmlChar *key,
+                    const xmlChar *key2, const xmlChar *key3,
+                    unsigned hashValue, const size_t *lengths,
+                    void *payload, xmlHashDeallocator dealloc, int update) {
     xmlChar *copy, *copy2, *copy3;
     xmlHashEntry *entry = NULL;
-    size_t lengths[3] = {0, 0, 0};
-    unsigned hashValue, newSize;
-
-    if ((hash == NULL) || (key == NULL))
-        return(-1);
-
-    hashValue = xmlHashValue(hash->randomSeed, key, key2, key3, lengths);
+    unsigned newSize, first, last;
 
     /*
      * Check for an existing entry
@@ -440,6 +866,8 @@ xmlHashUpdateInternal(xmlHashTable *hash, const xmlChar *key,
                 if (dealloc)
                     dealloc(entry->payload, entry->key);
                 entry->payload = payload;
+                xmlHashPtrSet(hash, entry->key, entry->key2, entry->key3,
+                              payload);
             }
 
             return(0);
@@ -543,6 +971,8 @@ xmlHashUpdateInternal(xmlHashTable *hash, const xmlChar *key,
     /*
      * Shift the remainder of the probe sequence to the right
      */
+    first = last = entry - hash->table;
+
     if (entry->hashValue != 0) {
         const xmlHashEntry *end = &hash->table[hash->size];
         const xmlHashEntry *cur = entry;
@@ -553,6 +983,8 @@ xmlHashUpdateInternal(xmlHashTable *hash, const xmlChar *key,
                 cur = hash->table;
         } while (cur->hashValue != 0);
 
+        last = cur - hash->table;
+
         if (cur < entry) {
             /*
              * If we traversed the end of the buffer, handle the part
@@ -577,11 +1009,131 @@ xmlHashUpdateInternal(xmlHashTable *hash, const xmlChar *key,
     /* OR with MAX_HASH_SIZE to make sure that the value is non-zero */
     entry->hashValue = hashValue | MAX_HASH_SIZE;
 
+    xmlHashSetTags(hash, first, last);
+
     hash->nbElems++;
 
+    xmlHashPtrSet(hash, copy, copy2, copy3, payload);
+
     return(1);
 }
 
+/**
+ * Internal function to add or update hash entries.
+ *
+ * @param hash  hash table
+ * @param key  first string key
+ * @param key2  second string key
+ * @param key3  third string key
+ * @param payload  pointer to the payload
+ * @param dealloc  deallocator function for replaced item or NULL
+ * @param update  whether existing entries should be updated
+ */
+static int
+xmlHashUpdateInternal(xmlHashTable *hash, const xmlChar *key,
+                      const xmlChar *key2, const xmlChar *key3,
+                      void *payload, xmlHashDeallocator dealloc, int update) {
+    size_t lengths[3] = {0, 0, 0};
+    unsigned hashValue;
+
+    if ((hash == NULL) || (key == NULL))
+        return(-1);
+
+    hashValue = xmlHashValue(hash->randomSeed, key, key2, key3, lengths);
+
+    return(xmlHashUpdateHashed(hash, key, key2, key3, hashValue, lengths,
+                               payload, dealloc, update));
+}
+
+typedef struct {
+    unsigned pos;
+    int index;
+    unsigned hashValue;
+    size_t length;
+} xmlHashBulkItem;
+
+static int
+xmlHashBulkItemCmp(const void *va, const void *vb) {
+    const xmlHashBulkItem *a = va;
+    const xmlHashBulkItem *b = vb;
+
+    if (a->pos != b->pos)
+        return(a->pos < b->pos ? -1 : 1);
+    return(a->index - b->index);
+}
+
+/**
+ * Add a batch of entries with a single string key. The table is
+ * resized once for all entries, which are then inserted in the order
+ * of their slots to keep accesses to the table sequential.
+ *
+ * Like with #xmlHashAdd, keys which already exist aren't replaced.
+ * If a key occurs several times in the batch, the first occurrence
+ * is added.
+ *
+ * @since 2.16.0
+ *
+ * @param hash  hash table
+ * @param nb  number of entries
+ * @param names  array of `nb` string keys
+ * @param userdata  array of `nb` payloads
+ * @returns the number of added entries or -1 if the arguments are
+ * invalid or a memory allocation failed.
+ */
+int
+xmlHashAddEntries(xmlHashTable *hash, int nb, const xmlChar *const *names,
+                  void *const *userdata) {
+    xmlHashBulkItem *items;
+    size_t lengths[3] = {0, 0, 0};
+    unsigned mask;
+    int i, res, ret = 0;
+
+    if ((hash == NULL) || (nb < 0) || (names == NULL) || (userdata == NULL))
+        return(-1);
+    if (nb == 0)
+        return(0);
+    if ((unsigned) nb > INT_MAX - hash->nbElems)
+        return(-1);
+    for (i = 0; i < nb; i++) {
+        if (names[i] == NULL)
+            return(-1);
+    }
+
+    if (xmlHashReserve(hash, hash->nbElems + nb) != 0)
+        return(-1);
+
+    items = xmlMalloc(nb * sizeof(items[0]));
+    if (items == NULL)
+        return(-1);
+
+    mask = hash->size - 1;
+    for (i = 0; i < nb; i++) {
+        items[i].hashValue = xmlHashValue(hash->randomSeed, names[i],
+                                          NULL, NULL, lengths);
+        items[i].length = lengths[0];
+        items[i].pos = items[i].hashValue & mask;
+        items[i].index = i;
+    }
+    qsort(items, nb, sizeof(items[0]), xmlHashBulkItemCmp);
+
+    for (i = 0; i < nb; i++) {
+        int index = items[i].index;
+
+        lengths[0] = items[i].length;
+        res = xmlHashUpdateHashed(hash, names[index], NULL, NULL,
+                                  items[i].hashValue, lengths,
+                                  userdata[index], NULL, 0);
+        if (res < 0) {
+            ret = -1;
+            break;
+        }
+        ret += res;
+    }
+
+    xmlFree(items);
+    return(ret);
+}
+
 /**
  * Free a hash table entry with xmlFree.
  *
@@ -866,22 +1418,110 @@ xmlHashQLookup2(xmlHashTable *hash, const xmlChar *prefix,
  * @param key3  third string key
  * @returns a pointer to the payload or NULL if no entry was found.
  */
+ATTRIBUTE_NO_SANITIZE_INTEGER
 void *
 xmlHashLookup3(xmlHashTable *hash, const xmlChar *key,
                const xmlChar *key2, const xmlChar *key3) {
     const xmlHashEntry *entry;
-    unsigned hashValue;
-    int found;
+    unsigned long long matches;
+    unsigned hashValue, mask, pos;
+    unsigned char tag;
+    int last;
 
     if ((hash == NULL) || (hash->size == 0) || (key == NULL))
         return(NULL);
     hashValue = xmlHashValue(hash->randomSeed, key, key2, key3, NULL);
-    entry = xmlHashFindEntry(hash, key, key2, key3, hashValue, &found);
-    if (found)
+    hashValue |= MAX_HASH_SIZE;
+    tag = HASH_TAG(hashValue);
+    mask = hash->size - 1;
+    pos = hashValue & mask;
+
+    /*
+     * Most successful lookups hit the initial probe position.
+     */
+    entry = &hash->table[pos];
+    if (entry->hashValue == 0)
+        return(NULL);
+    if ((entry->hashValue == hashValue) &&
+        (xmlHashEntryEqual(hash, entry, key, key2, key3)))
         return(entry->payload);
+
+    /*
+     * The table is never full, so this terminates.
+     */
+    do {
+        matches = xmlHashGroupCandidates(&hash->tags[pos], tag, &last);
+
+        while (matches != 0) {
+            entry = &hash->table[(pos + (xmlCountTrailingZeros(matches) >>
+                                         HASH_LANE_SHIFT)) & mask];
+
+            if ((entry->hashValue == hashValue) &&
+                (xmlHashEntryEqual(hash, entry, key, key2, key3)))
+                return(entry->payload);
+
+            matches &= matches - 1;
+        }
+
+        pos = (pos + HASH_GROUP_SIZE) & mask;
+    } while (!last);
+
     return(NULL);
 }
 
+/**
+ * Find the payload specified by the (`key`, `key2`, `key3`) tuple.
+ * If the keys are owned by the dictionary of a table indexed with
+ * #xmlHashIndexInterned, only their addresses are hashed and
+ * compared. Other keys are looked up like with #xmlHashLookup3.
+ *
+ * @param hash  hash table
+ * @param key  first string key
+ * @param key2  second string key
+ * @param key3  third string key
+ * @returns a pointer to the payload or NULL if no entry was found.
+ */
+void *
+xmlHashLookupInterned3(xmlHashTable *hash, const xmlChar *key,
+                       const xmlChar *key2, const xmlChar *key3) {
+    const xmlHashPtrEntry *entry;
+
+    if ((hash == NULL) || (key == NULL))
+        return(NULL);
+    if (hash->ptrIndex != NULL) {
+        entry = xmlHashPtrFind(hash->ptrIndex, key, key2, key3);
+        if (entry->key != NULL)
+            return(entry->payload);
+    }
+    return(xmlHashLookup3(hash, key, key2, key3));
+}
+
+/**
+ * See #xmlHashLookupInterned3.
+ *
+ * @param hash  hash table
+ * @param key  string key
+ * @returns a pointer to the payload or NULL if no entry was found.
+ */
+void *
+xmlHashLookupInterned(xmlHashTable *hash, const xmlChar *key) {
+    return(xmlHashLookupInterned3(hash, key, NULL, NULL));
+}
+
+/**
+ * See #xmlHashLookupInterned3.
+ *
+ * @param hash  hash table
+ * @param key  first string key
+ * @param key2  second string key
+ * @returns a pointer to the payload or NULL if no entry was found.
+ */
+void *
+xmlHashLookupInterned2(xmlHashTable *hash, const xmlChar *key,
+                       const xmlChar *key2) {
+    return(xmlHashLookupInterned3(hash, key, key2, NULL));
+}
+
 /**
  * Find the payload specified by the QNames tuple.
  *
@@ -901,36 +1541,48 @@ xmlHashQLookup3(xmlHashTable *hash,
                 const xmlChar *prefix2, const xmlChar *name2,
                 const xmlChar *prefix3, const xmlChar *name3) {
     const xmlHashEntry *entry;
-    unsigned hashValue, mask, pos, displ;
+    unsigned long long matches;
+    unsigned hashValue, mask, pos;
+    unsigned char tag;
+    int last;
 
     if ((hash == NULL) || (hash->size == 0) || (name == NULL))
         return(NULL);
 
     hashValue = xmlHashQNameValue(hash->randomSeed, prefix, name, prefix2,
                                   name2, prefix3, name3);
+    hashValue |= MAX_HASH_SIZE;
+    tag = HASH_TAG(hashValue);
     mask = hash->size - 1;
     pos = hashValue & mask;
+
     entry = &hash->table[pos];
+    if (entry->hashValue == 0)
+        return(NULL);
+    if ((hashValue == entry->hashValue) &&
+        (xmlStrQEqual(prefix, name, entry->key)) &&
+        (xmlStrQEqual(prefix2, name2, entry->key2)) &&
+        (xmlStrQEqual(prefix3, name3, entry->key3)))
+        return(entry->payload);
 
-    if (entry->hashValue != 0) {
-        displ = 0;
-        hashValue |= MAX_HASH_SIZE;
+    do {
+        matches = xmlHashGroupCandidates(&hash->tags[pos], tag, &last);
+
+        while (matches != 0) {
+            entry = &hash->table[(pos + (xmlCountTrailingZeros(matches) >>
+                                         HASH_LANE_SHIFT)) & mask];
 
-        do {
             if ((hashValue == entry->hashValue) &&
                 (xmlStrQEqual(prefix, name, entry->key)) &&
                 (xmlStrQEqual(prefix2, name2, entry->key2)) &&
                 (xmlStrQEqual(prefix3, name3, entry->key3)))
                 return(entry->payload);
 
-            displ++;
-            pos++;
-            entry++;
-            if ((pos & mask) == 0)
-                entry = hash->table;
-        } while ((entry->hashValue != 0) &&
-                 (((pos - entry->hashValue) & mask) >= displ));
-    }
+            matches &= matches - 1;
+        }
+
+        pos = (pos + HASH_GROUP_SIZE) & mask;
+    } while (!last);
 
     return(NULL);
 }
@@ -1115,7 +1767,7 @@ xmlHashCopySafe(xmlHashTable *hash, xmlHashCopier copyFunc,
     if ((hash == NULL) || (copyFunc == NULL))
         return(NULL);
 
-    ret = xmlHashCreate(hash->size);
+    ret = xmlHashCreate(hash->nbElems);
     if (ret == NULL)
         return(NULL);
 
@@ -1225,7 +1877,7 @@ xmlHashRemoveEntry3(xmlHashTable *hash, const xmlChar *key,
                     const xmlChar *key2, const xmlChar *key3,
                     xmlHashDeallocator dealloc) {
     xmlHashEntry *entry, *cur, *next;
-    unsigned hashValue, mask, pos, nextpos;
+    unsigned hashValue, mask, pos, nextpos, first, last;
     int found;
 
     if ((hash == NULL) || (hash->size == 0) || (key == NULL))
@@ -1236,6 +1888,8 @@ xmlHashRemoveEntry3(xmlHashTable *hash, const xmlChar *key,
     if (!found)
         return(-1);
 
+    xmlHashPtrRemove(hash, entry->key, entry->key2, entry->key3);
+
     if ((dealloc != NULL) && (entry->payload != NULL))
         dealloc(entry->payload, entry->key);
     if (hash->dict == NULL) {
@@ -1272,6 +1926,8 @@ xmlHashRemoveEntry3(xmlHashTable *hash, const xmlChar *key,
     /*
      * Backward shift
      */
+    first = entry - hash->table;
+    last = pos & mask;
     next = entry + 1;
 
     if (cur < entry) {
@@ -1290,6 +1946,8 @@ xmlHashRemoveEntry3(xmlHashTable *hash, const xmlChar *key,
      */
     cur->hashValue = 0;
 
+    xmlHashSetTags(hash, first, last);
+
     hash->nbElems--;
 
     return(0);
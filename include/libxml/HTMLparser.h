@@ -366,6 +366,79 @@ XMLPUBFUN xmlDoc *
 					 const char *encoding,
 					 int options);
 
+/*
+ * Token streaming
+ */
+
+/**
+ * Token types returned by #htmlTokenizerNext.
+ *
+ * @since 2.16.0
+ */
+typedef enum {
+    /** End of input */
+    HTML_TOKEN_EOF = 0,
+    /** Start tag */
+    HTML_TOKEN_START_TAG,
+    /** End tag */
+    HTML_TOKEN_END_TAG,
+    /** Text */
+    HTML_TOKEN_TEXT,
+    /** Comment, including bogus comments */
+    HTML_TOKEN_COMMENT,
+    /** DOCTYPE declaration */
+    HTML_TOKEN_DOCTYPE
+} htmlTokenType;
+
+/**
+ * An attribute of a start tag. Strings aren't NUL-terminated.
+ *
+ * @since 2.16.0
+ */
+typedef struct {
+    /** lowercase attribute name */
+    const xmlChar *name;
+    /** length of the name in bytes */
+    int nameLen;
+    /** attribute value or NULL if the attribute has no value */
+    const xmlChar *value;
+    /** length of the value in bytes */
+    int valueLen;
+} htmlTokenAttr;
+
+/**
+ * A token returned by #htmlTokenizerNext. Strings aren't
+ * NUL-terminated.
+ *
+ * @since 2.16.0
+ */
+typedef struct {
+    /** token type */
+    htmlTokenType type;
+    /** lowercase tag or DOCTYPE name, text or comment content */
+    const xmlChar *data;
+    /** length of the data in bytes */
+    int len;
+    /** whether a start tag ends with "/>" */
+    int selfClosing;
+    /** attributes of a start tag */
+    const htmlTokenAttr *attrs;
+    /** number of attributes */
+    int nbAttrs;
+} htmlToken;
+
+/** HTML5 tokenizer without tree construction */
+typedef struct _htmlTokenizer htmlTokenizer;
+
+XMLPUBFUN htmlTokenizer *
+		htmlNewTokenizer	(const char *buffer,
+					 int size);
+XMLPUBFUN int
+		htmlTokenizerNext	(htmlTokenizer *tok,
+					 htmlToken *token);
+XMLPUBFUN void
+		htmlFreeTokenizer	(htmlTokenizer *tok);
+
 /**
  * deprecated content model
  */
@@ -26,6 +26,9 @@
 
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
+#ifdef LIBXML_READER_ENABLED
+#include <libxml/xmlreader.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -107,6 +110,60 @@ XMLPUBFUN int
 					 int with_comments,
 					 xmlOutputBuffer *buf);
 
+/**
+ * Receives a chunk of canonical output, typically to update a digest
+ *
+ * @param ctxt  user data
+ * @param data  the canonical bytes
+ * @param len  the number of bytes
+ * @returns 0 on success or -1 to abort canonicalization
+ */
+typedef int (*xmlC14NDigestCallback)	(void *ctxt,
+					 const unsigned char *data,
+					 int len);
+
+/**
+ * A reference canonicalized by #xmlC14NDigestReferences
+ */
+typedef struct _xmlC14NReference xmlC14NReference;
+struct _xmlC14NReference {
+    /** the nodes to include or NULL for the whole document */
+    xmlNodeSet *nodes;
+    /** the c14n mode (see `xmlC14NMode`) */
+    int mode;
+    /** inclusive namespace prefixes for exclusive canonicalization */
+    xmlChar **inclusive_ns_prefixes;
+    /** include comments */
+    int with_comments;
+    /** receives the canonical output */
+    xmlC14NDigestCallback digest;
+    /** first argument of digest */
+    void *ctxt;
+};
+
+XMLPUBFUN int
+		xmlC14NDocDigest	(xmlDoc *doc,
+					 xmlNodeSet *nodes,
+					 int mode, /* a xmlC14NMode */
+					 xmlChar **inclusive_ns_prefixes,
+					 int with_comments,
+					 xmlC14NDigestCallback digest,
+					 void *ctxt);
+
+XMLPUBFUN int
+		xmlC14NDigestReferences	(xmlDoc *doc,
+					 xmlC14NReference *refs,
+					 int nbRefs);
+
+#ifdef LIBXML_READER_ENABLED
+XMLPUBFUN int
+		xmlC14NReaderSaveTo	(xmlTextReader *reader,
+					 int mode, /* a xmlC14NMode */
+					 xmlChar **inclusive_ns_prefixes,
+					 int with_comments,
+					 xmlOutputBuffer *buf);
+#endif /* LIBXML_READER_ENABLED */
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -184,6 +184,8 @@ XMLPUBFUN xmlChar *
  */
 XMLPUBFUN int
 		xmlCatalogSetDebug	(int level);
+XMLPUBFUN void
+		xmlCatalogSetMemoLimit	(int maxEntries);
 XML_DEPRECATED
 XMLPUBFUN xmlCatalogPrefer
 		xmlCatalogSetDefaultPrefer(xmlCatalogPrefer prefer);
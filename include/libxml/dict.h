@@ -44,12 +44,30 @@ XMLPUBFUN size_t
                                          size_t limit);
 XMLPUBFUN size_t
 			xmlDictGetUsage (xmlDict *dict);
+XMLPUBFUN int
+			xmlDictReserve	(xmlDict *dict,
+					 int size);
 XMLPUBFUN xmlDict *
 			xmlDictCreateSub(xmlDict *sub);
+XMLPUBFUN xmlDict *
+			xmlDictCreateConcurrent(void);
 XMLPUBFUN int
 			xmlDictReference(xmlDict *dict);
 XMLPUBFUN void
 			xmlDictFree	(xmlDict *dict);
+XMLPUBFUN int
+			xmlDictFreeze	(xmlDict *dict);
+
+/*
+ * Snapshots
+ */
+XMLPUBFUN int
+			xmlDictSave	(xmlDict *dict,
+					 unsigned char **mem,
+					 size_t *size);
+XMLPUBFUN xmlDict *
+			xmlDictLoad	(const unsigned char *mem,
+					 size_t size);
 
 /*
  * Lookup of entry in the dictionary.
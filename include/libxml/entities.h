@@ -140,6 +140,12 @@ XMLPUBFUN xmlChar *
 XMLPUBFUN xmlChar *
 			xmlEncodeSpecialChars	(const xmlDoc *doc,
 						 const xmlChar *input);
+XMLPUBFUN xmlChar *
+			xmlEncodeEntitiesNoCopy	(xmlDoc *doc,
+						 const xmlChar *input);
+XMLPUBFUN xmlChar *
+			xmlEncodeSpecialCharsNoCopy(const xmlDoc *doc,
+						 const xmlChar *input);
 XML_DEPRECATED
 XMLPUBFUN xmlEntitiesTable *
 			xmlCreateEntitiesTable	(void);
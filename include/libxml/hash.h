@@ -102,6 +102,9 @@ XMLPUBFUN void
 XMLPUBFUN void
 		xmlHashDefaultDeallocator(void *entry,
 					 const xmlChar *name);
+XMLPUBFUN int
+		xmlHashReserve		(xmlHashTable *hash,
+					 int size);
 
 /*
  * Add a new entry to the hash table.
@@ -110,6 +113,11 @@ XMLPUBFUN int
 		xmlHashAdd		(xmlHashTable *hash,
 		                         const xmlChar *name,
 		                         void *userdata);
+XMLPUBFUN int
+		xmlHashAddEntries	(xmlHashTable *hash,
+					 int nb,
+					 const xmlChar *const *names,
+					 void *const *userdata);
 XMLPUBFUN int
 		xmlHashAddEntry		(xmlHashTable *hash,
 		                         const xmlChar *name,
@@ -89,7 +89,13 @@ typedef enum {
     /** Allow network access. Unused internally. */
     XML_INPUT_NETWORK               = (1 << 4),
     /** Allow system catalog to resolve URIs. */
-    XML_INPUT_USE_SYS_CATALOG       = (1 << 5)
+    XML_INPUT_USE_SYS_CATALOG       = (1 << 5),
+    /** Map regular files into memory instead of reading them.
+        @since 2.16.0 */
+    XML_INPUT_MMAP                  = (1 << 6),
+    /** Read regular files ahead in a separate thread.
+        @since 2.16.0 */
+    XML_INPUT_ASYNC                 = (1 << 7)
 } xmlParserInputFlags;
 
 /* Deprecated */
@@ -153,6 +159,11 @@ struct _xmlParserInput {
     unsigned long parentConsumed XML_DEPRECATED_MEMBER;
     /* entity, if any */
     xmlEntity *entity XML_DEPRECATED_MEMBER;
+    /* byte position of the line checkpoint, see xmlCtxtSetLazyLines */
+    unsigned long lineCheck XML_DEPRECATED_MEMBER;
+    /* line and column at the checkpoint */
+    int checkLine XML_DEPRECATED_MEMBER;
+    int checkCol XML_DEPRECATED_MEMBER;
 };
 
 /** @cond ignore */
@@ -224,6 +235,7 @@ typedef enum {
 typedef struct _xmlStartTag xmlStartTag;
 typedef struct _xmlParserNsData xmlParserNsData;
 typedef struct _xmlAttrHashBucket xmlAttrHashBucket;
+typedef struct _xmlMemBudget xmlMemBudget;
 
 /** @endcond */
 
@@ -251,6 +263,106 @@ typedef xmlParserErrors
                      xmlResourceType type, xmlParserInputFlags flags,
                      xmlParserInput **out);
 
+/**
+ * Callback receiving the content of large text nodes, see
+ * #xmlCtxtSetTextSink.
+ *
+ * The content of a node is passed in one or more calls with `more`
+ * set, followed by a final call with `more` unset and an empty
+ * chunk once the node is complete. The final call may set the
+ * content of the node, for example to a reference to the stored
+ * data.
+ *
+ * @param data  user data
+ * @param node  the text or CDATA node
+ * @param chunk  the next part of the content
+ * @param len  length of the chunk in bytes
+ * @param more  whether the content continues
+ * @returns 0 on success or -1 to stop the parser.
+ */
+typedef int
+(*xmlTextSinkFunc)(void *data, xmlNode *node, const xmlChar *chunk,
+                   int len, int more);
+
+/**
+ * Callback receiving the documents of a stream of concatenated
+ * documents, see #xmlCtxtSetDocStream.
+ *
+ * The callback takes ownership of the document, which must be
+ * freed with #xmlFreeDoc. `doc` is NULL if no tree is built.
+ *
+ * @param data  user data
+ * @param doc  the completed document
+ * @param status  an xmlParserErrors code (0 if well-formed)
+ * @returns 0 to continue or -1 to stop the parser.
+ */
+typedef int
+(*xmlDocStreamFunc)(void *data, xmlDoc *doc, int status);
+
+/**
+ * Statistics about a parse run, see #xmlCtxtGetStats
+ */
+typedef struct {
+    /** bytes read from input sources, before decoding */
+    unsigned long bytesRead;
+    /** bytes of UTF-8 consumed by the parser */
+    unsigned long bytesDecoded;
+    /** number of times an input buffer was refilled */
+    unsigned long inputGrows;
+    /** number of times consumed input was discarded */
+    unsigned long inputShrinks;
+    /** tree nodes created by the default SAX handlers */
+    unsigned long nodes;
+    /** attributes created by the default SAX handlers */
+    unsigned long attributes;
+    /** namespace definitions created by the default SAX handlers */
+    unsigned long namespaces;
+    /** dictionary lookups of strings which were already interned */
+    unsigned long dictHits;
+    /** strings added to the dictionary */
+    unsigned long dictInserts;
+    /** number of entity expansions */
+    unsigned long entityExpansions;
+    /** bytes produced by entity expansion */
+    unsigned long entityBytes;
+    /** entity bytes per input byte, see #xmlCtxtSetMaxAmplification */
+    double amplification;
+    /** maximum element depth */
+    int maxDepth;
+    /** seconds spent in encoding conversion, see #xmlCtxtSetStatsTiming */
+    double encodingTime;
+} xmlParserStats;
+
+/**
+ * A document parsed by #xmlReadBatch
+ */
+typedef struct {
+    /** document in memory or NULL to read `filename` */
+    const char *buffer;
+    /** size of the buffer */
+    int size;
+    /** file to read or base URL of the buffer (optional) */
+    const char *filename;
+    /** the resulting document if no callback was passed */
+    xmlDoc *doc;
+    /** code of the last error or 0 */
+    int error;
+} xmlBatchItem;
+
+/**
+ * Receives a document parsed by #xmlReadBatch. The callback is
+ * invoked from worker threads, possibly concurrently, and takes
+ * ownership of the document.
+ *
+ * @param data  user data
+ * @param index  index of the item
+ * @param doc  the resulting document or NULL
+ * @param error  the last error of the parse run or NULL
+ */
+typedef void
+(*xmlBatchDocFunc)(void *data, int index, xmlDoc *doc,
+                   const xmlError *error);
+
 /**
  * Parser context
  */
@@ -641,6 +753,69 @@ struct _xmlParserCtxt {
 
     xmlCharEncConvImpl convImpl XML_DEPRECATED_MEMBER;
     void *convCtxt XML_DEPRECATED_MEMBER;
+
+    /* memory budget */
+    xmlMemBudget *memBudget XML_DEPRECATED_MEMBER;
+
+    /* time limit in milliseconds */
+    unsigned long timeLimit XML_DEPRECATED_MEMBER;
+    /* deadline of the parse run */
+    unsigned long deadline XML_DEPRECATED_MEMBER;
+    /* checks since the clock was read */
+    unsigned interruptChecks XML_DEPRECATED_MEMBER;
+    /* set by xmlStopParser, possibly from another thread */
+    volatile int stopRequested XML_DEPRECATED_MEMBER;
+    /* only mark ID attributes and collect them on the first lookup */
+    int lazyIds XML_DEPRECATED_MEMBER;
+    /* keep the source text of the document */
+    int keepSource XML_DEPRECATED_MEMBER;
+    /* source spans recorded while parsing */
+    void *sourceSpans XML_DEPRECATED_MEMBER;
+    /* errors recorded without formatting the message */
+    void *errorRing XML_DEPRECATED_MEMBER;
+    /* limits on reported errors */
+    void *errorPolicy XML_DEPRECATED_MEMBER;
+    /* start time of a traced push parse */
+    double traceStart XML_DEPRECATED_MEMBER;
+    /* statistics, see xmlCtxtGetStats */
+    xmlParserStats stats XML_DEPRECATED_MEMBER;
+    /* dictionary counters when the statistics were reset */
+    unsigned long statsDictLookups XML_DEPRECATED_MEMBER;
+    unsigned long statsDictSize XML_DEPRECATED_MEMBER;
+    /* measure the time spent in encoding conversion */
+    int statsTiming XML_DEPRECATED_MEMBER;
+    /* report CDATA sections in chunks */
+    int chunkedText XML_DEPRECATED_MEMBER;
+    /* state of the text chunk being reported */
+    int partialText XML_DEPRECATED_MEMBER;
+    /* receives the content of large text nodes */
+    xmlTextSinkFunc textSink XML_DEPRECATED_MEMBER;
+    void *textSinkData XML_DEPRECATED_MEMBER;
+    int textSinkThreshold XML_DEPRECATED_MEMBER;
+    /* node whose content currently goes to the text sink */
+    xmlNode *textSinkNode XML_DEPRECATED_MEMBER;
+    /* compute line numbers on demand */
+    int lazyLines XML_DEPRECATED_MEMBER;
+    /* threads for parallel parsing */
+    int parallelThreads XML_DEPRECATED_MEMBER;
+    /* patterns selecting the subtrees to build */
+    void **filterPatterns XML_DEPRECATED_MEMBER;
+    int nbFilterPatterns XML_DEPRECATED_MEMBER;
+    /* stream contexts of the patterns or NULL if not filtering */
+    void **filterStreams XML_DEPRECATED_MEMBER;
+    /* depth in a selected subtree, 0 outside */
+    int filterDepth XML_DEPRECATED_MEMBER;
+    /* templates for copying the content of entities */
+    xmlHashTable *entTemplates XML_DEPRECATED_MEMBER;
+    /* default and special attributes compiled per element */
+    xmlHashTable *attsPlans XML_DEPRECATED_MEMBER;
+    /* receives the documents of a stream */
+    xmlDocStreamFunc docStream XML_DEPRECATED_MEMBER;
+    void *docStreamData XML_DEPRECATED_MEMBER;
+    /* documents completed in stream mode */
+    int streamDocs XML_DEPRECATED_MEMBER;
+    /* schema validation context receiving events directly */
+    void *schemaValid XML_DEPRECATED_MEMBER;
 };
 
 /**
@@ -1586,6 +1761,11 @@ XMLPUBFUN int
 					 const xmlChar *ID,
 					 xmlNode **lst);
 
+/**
+ * A pool of reusable parser contexts.
+ */
+typedef struct _xmlParserCtxtPool xmlParserCtxtPool;
+
 /*
  * Parser contexts handling.
  */
@@ -1601,6 +1781,15 @@ XMLPUBFUN void
 		xmlClearParserCtxt	(xmlParserCtxt *ctxt);
 XMLPUBFUN void
 		xmlFreeParserCtxt	(xmlParserCtxt *ctxt);
+XMLPUBFUN xmlParserCtxtPool *
+		xmlNewParserCtxtPool	(int maxSize);
+XMLPUBFUN void
+		xmlFreeParserCtxtPool	(xmlParserCtxtPool *pool);
+XMLPUBFUN xmlParserCtxt *
+		xmlParserCtxtPoolAcquire(xmlParserCtxtPool *pool);
+XMLPUBFUN void
+		xmlParserCtxtPoolRelease(xmlParserCtxtPool *pool,
+					 xmlParserCtxt *ctxt);
 #ifdef LIBXML_SAX1_ENABLED
 XML_DEPRECATED
 XMLPUBFUN void
@@ -1626,6 +1815,11 @@ XMLPUBFUN int
 					 const char *chunk,
 					 int size,
 					 int terminate);
+XMLPUBFUN int
+		xmlParseChunkBorrowed	(xmlParserCtxt *ctxt,
+					 const char *chunk,
+					 int size,
+					 int terminate);
 #endif /* LIBXML_PUSH_ENABLED */
 
 /*
@@ -1862,7 +2056,8 @@ typedef enum {
     XML_PARSE_NO_XXE = 1<<23,
     /**
      * Enable input decompression. Setting this option is discouraged
-     * to avoid zip bombs.
+     * to avoid zip bombs. Handles gzip and, since 2.16.0, Zstandard
+     * compressed files if the respective support was compiled in.
      *
      * @since 2.14.0
      */
@@ -1884,7 +2079,42 @@ typedef enum {
      *
      * @since 2.15.0
      */
-    XML_PARSE_SKIP_IDS = 1<<27
+    XML_PARSE_SKIP_IDS = 1<<27,
+    /**
+     * Map local files into memory and parse directly from the
+     * mapping instead of reading them into a buffer. Only has an
+     * effect on platforms supporting mmap. Files in encodings other
+     * than UTF-8 are still converted into a separate buffer.
+     *
+     * The file must not be truncated while it's parsed.
+     *
+     * @since 2.16.0
+     */
+    XML_PARSE_MMAP = 1<<28,
+    /**
+     * Allocate element, attribute and text nodes from an arena
+     * owned by the document. Nodes are only released in bulk when
+     * the document is freed which speeds up both parsing and
+     * freeing large documents.
+     *
+     * Nodes of arena documents must not be moved to other
+     * documents. Unlinked nodes must not be used after the
+     * document was freed. This option is ignored by the
+     * xmlReader API.
+     *
+     * @since 2.16.0
+     */
+    XML_PARSE_ARENA = 1<<29,
+    /**
+     * Read local files ahead in a background thread, so that
+     * parsing overlaps with I/O. Compressed files are decompressed
+     * in the background thread. Only has an effect on regular
+     * files if the library was built with POSIX thread support.
+     * Ignored if XML_PARSE_MMAP maps the file.
+     *
+     * @since 2.16.0
+     */
+    XML_PARSE_ASYNC_IO = 1<<30
 } xmlParserOption;
 
 XMLPUBFUN void
@@ -1969,10 +2199,37 @@ XMLPUBFUN void
 		xmlCtxtSetErrorHandler	(xmlParserCtxt *ctxt,
 					 xmlStructuredErrorFunc handler,
 					 void *data);
+XMLPUBFUN int
+		xmlCtxtSetDeferredErrors(xmlParserCtxt *ctxt,
+					 int size);
+XMLPUBFUN int
+		xmlCtxtGetDeferredError	(xmlParserCtxt *ctxt,
+					 int index,
+					 xmlError *err);
+XMLPUBFUN int
+		xmlCtxtSetErrorPolicy	(xmlParserCtxt *ctxt,
+					 int maxErrors,
+					 int maxPerCode,
+					 int dedup);
+XMLPUBFUN int
+		xmlCtxtGetErrorCount	(xmlParserCtxt *ctxt,
+					 int code,
+					 int nodeType);
 XMLPUBFUN void
 		xmlCtxtSetResourceLoader(xmlParserCtxt *ctxt,
 					 xmlResourceLoader loader,
 					 void *vctxt);
+XMLPUBFUN void
+		xmlResourceCacheSetLimits(size_t maxSize,
+					 size_t maxEntrySize);
+XMLPUBFUN void
+		xmlResourceCacheClear	(void);
+XMLPUBFUN int
+		xmlDtdCacheAdd		(xmlDtd *dtd,
+					 const xmlChar *publicId,
+					 const xmlChar *systemId);
+XMLPUBFUN void
+		xmlDtdCacheClear	(void);
 XMLPUBFUN void
 		xmlCtxtSetCharEncConvImpl(xmlParserCtxt *ctxt,
 					 xmlCharEncConvImpl impl,
@@ -1980,6 +2237,46 @@ XMLPUBFUN void
 XMLPUBFUN void
 		xmlCtxtSetMaxAmplification(xmlParserCtxt *ctxt,
 					 unsigned maxAmpl);
+XMLPUBFUN int
+		xmlCtxtSetMaxMemory	(xmlParserCtxt *ctxt,
+					 size_t maxMem);
+XMLPUBFUN size_t
+		xmlCtxtGetMemoryUsed	(xmlParserCtxt *ctxt);
+XMLPUBFUN void
+		xmlCtxtSetLazyIds	(xmlParserCtxt *ctxt,
+					 int lazy);
+XMLPUBFUN void
+		xmlCtxtSetSourceSpans	(xmlParserCtxt *ctxt,
+					 int keep);
+XMLPUBFUN void
+		xmlCtxtSetTimeLimit	(xmlParserCtxt *ctxt,
+					 unsigned long ms);
+XMLPUBFUN int
+		xmlCtxtGetStats		(xmlParserCtxt *ctxt,
+					 xmlParserStats *stats);
+XMLPUBFUN void
+		xmlCtxtSetStatsTiming	(xmlParserCtxt *ctxt,
+					 int enable);
+XMLPUBFUN void
+		xmlCtxtSetChunkedText	(xmlParserCtxt *ctxt,
+					 int enable);
+XMLPUBFUN int
+		xmlCtxtIsTextPartial	(xmlParserCtxt *ctxt);
+XMLPUBFUN int
+		xmlCtxtSetTextSink	(xmlParserCtxt *ctxt,
+					 int threshold,
+					 xmlTextSinkFunc sink,
+					 void *data);
+XMLPUBFUN void
+		xmlCtxtSetLazyLines	(xmlParserCtxt *ctxt,
+					 int enable);
+XMLPUBFUN int
+		xmlCtxtSetParallel	(xmlParserCtxt *ctxt,
+					 int nbThreads);
+XMLPUBFUN int
+		xmlCtxtSetDocStream	(xmlParserCtxt *ctxt,
+					 xmlDocStreamFunc func,
+					 void *data);
 XMLPUBFUN xmlDoc *
 		xmlReadDoc		(const xmlChar *cur,
 					 const char *URL,
@@ -2047,6 +2344,14 @@ XMLPUBFUN xmlDoc *
 					 const char *URL,
 					 const char *encoding,
 					 int options);
+XMLPUBFUN int
+		xmlReadBatch		(xmlBatchItem *items,
+					 int nbItems,
+					 xmlDict *dict,
+					 const char *encoding,
+					 int options,
+					 xmlBatchDocFunc func,
+					 void *data);
 
 /*
  * New input API
@@ -2149,6 +2454,8 @@ typedef enum {
     XML_WITH_LZMA = 33,
     /** RELAXNG, since 2.14 */
     XML_WITH_RELAXNG = 34,
+    /** Zstandard compression, since 2.16 */
+    XML_WITH_ZSTD = 35,
     XML_WITH_NONE = 99999 /* just to be sure of allocation size */
 } xmlFeature;
 
@@ -95,6 +95,40 @@ XMLPUBFUN int
 			xmlStreamPop		(xmlStreamCtxt *stream);
 XMLPUBFUN int
 			xmlStreamWantsAnyNode	(xmlStreamCtxt *stream);
+
+/** A set of patterns matched by a single streaming automaton */
+typedef struct _xmlPatternSet xmlPatternSet;
+typedef xmlPatternSet *xmlPatternSetPtr;
+/** State object for streaming a pattern set */
+typedef struct _xmlPatternSetStream xmlPatternSetStream;
+typedef xmlPatternSetStream *xmlPatternSetStreamPtr;
+
+XMLPUBFUN xmlPatternSet *
+			xmlNewPatternSet	(void);
+XMLPUBFUN void
+			xmlFreePatternSet	(xmlPatternSet *set);
+XMLPUBFUN int
+			xmlPatternSetAdd	(xmlPatternSet *set,
+						 xmlPattern *comp,
+						 int id);
+XMLPUBFUN xmlPatternSetStream *
+			xmlPatternSetGetStreamCtxt(xmlPatternSet *set);
+XMLPUBFUN void
+			xmlFreePatternSetStream	(xmlPatternSetStream *stream);
+XMLPUBFUN int
+			xmlPatternSetPush	(xmlPatternSetStream *stream,
+						 const xmlChar *name,
+						 const xmlChar *ns,
+						 const int **ids);
+XMLPUBFUN int
+			xmlPatternSetPop	(xmlPatternSetStream *stream);
+XMLPUBFUN int
+			xmlPatternSetWantsDescendants(xmlPatternSetStream *stream);
+
+XMLPUBFUN int
+			xmlCtxtSetPatternFilter	(xmlParserCtxt *ctxt,
+						 xmlPattern **patterns,
+						 int nbPatterns);
 #ifdef __cplusplus
 }
 #endif
@@ -161,6 +161,20 @@ XMLPUBFUN xmlRelaxNG *
 		    xmlRelaxNGParse		(xmlRelaxNGParserCtxt *ctxt);
 XMLPUBFUN void
 		    xmlRelaxNGFree		(xmlRelaxNG *schema);
+#ifdef LIBXML_OUTPUT_ENABLED
+XMLPUBFUN int
+		    xmlRelaxNGSave		(xmlRelaxNG *schema,
+					 const char *filename);
+#endif /* LIBXML_OUTPUT_ENABLED */
+XMLPUBFUN int
+		    xmlRelaxNGSaveMemory	(xmlRelaxNG *schema,
+					 xmlChar **mem,
+					 int *size);
+XMLPUBFUN xmlRelaxNG *
+		    xmlRelaxNGLoad		(const char *filename);
+XMLPUBFUN xmlRelaxNG *
+		    xmlRelaxNGLoadMemory	(const char *mem,
+					 int size);
 #ifdef LIBXML_DEBUG_ENABLED
 XMLPUBFUN void
 		    xmlRelaxNGDump		(FILE *output,
@@ -187,6 +201,18 @@ XMLPUBFUN int
 XMLPUBFUN void
 			xmlRelaxNGSetValidStructuredErrors(xmlRelaxNGValidCtxt *ctxt,
 					  xmlStructuredErrorFunc serror, void *ctx);
+XMLPUBFUN int
+		    xmlRelaxNGSetValidDerivatives(xmlRelaxNGValidCtxt *ctxt,
+					 int derivatives);
+XMLPUBFUN int
+		    xmlRelaxNGSetValidErrorPolicy(xmlRelaxNGValidCtxt *ctxt,
+					 int maxErrors,
+					 int maxPerCode,
+					 int dedup);
+XMLPUBFUN int
+		    xmlRelaxNGValidGetErrorCount(xmlRelaxNGValidCtxt *ctxt,
+					 int code,
+					 int nodeType);
 XMLPUBFUN xmlRelaxNGValidCtxt *
 		    xmlRelaxNGNewValidCtxt	(xmlRelaxNG *schema);
 XMLPUBFUN void
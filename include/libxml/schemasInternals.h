@@ -301,6 +301,7 @@ struct _xmlSchemaWildcard {
     xmlSchemaWildcardNs *nsSet; /* The list of allowed namespaces */
     xmlSchemaWildcardNs *negNsSet; /* The negated namespace */
     int flags;
+    void *nsIndex; /* Private index of the namespace set */
 };
 
 /**
@@ -546,6 +547,8 @@ struct _xmlSchemaType {
     xmlRegexp *contModel; /* Holds the automaton of the content model */
     const xmlChar *targetNamespace;
     void *attrUses;
+    void *allModel; /* Private model of an <all> content model */
+    void *enumIndex; /* Private index of enumeration facets */
 };
 
 /**
@@ -792,6 +795,7 @@ struct _xmlSchema {
     int counter; /* used to give anonymous components unique names */
     xmlHashTable *idcDef; /* All identity-constraint defs. */
     void *volatiles; /* Obsolete */
+    void *lazyImports; /* imports loaded on demand, this is opaque */
 };
 
 XMLPUBFUN void         xmlSchemaFreeType        (xmlSchemaType *type);
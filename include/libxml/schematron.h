@@ -113,6 +113,9 @@ XMLPUBFUN void
 	                                  xmlSchematronValidCtxt *ctxt,
 					  xmlStructuredErrorFunc serror,
 					  void *ctx);
+XMLPUBFUN int
+	    xmlSchematronSetValidParallel(xmlSchematronValidCtxt *ctxt,
+					  int nbThreads);
 /******
 XMLPUBFUN void
 	    xmlSchematronSetValidErrors	(xmlSchematronValidCtxt *ctxt,
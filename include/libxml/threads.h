@@ -49,6 +49,44 @@ XMLPUBFUN void
 XMLPUBFUN void
 			xmlFreeRMutex	(xmlRMutex *tok);
 
+/**
+ * Function run by a task of the thread pool
+ *
+ * @param arg  argument passed when submitting the task
+ */
+typedef void (*xmlTaskFunc)(void *arg);
+
+/**
+ * Callback which hands a task to an external executor. The executor
+ * must eventually call `func(arg)` exactly once.
+ *
+ * @param executor  user data of the executor
+ * @param func  function to run
+ * @param arg  argument for the function
+ * @returns 0 if the task was accepted, -1 otherwise
+ */
+typedef int (*xmlTaskExecutorFunc)(void *executor, xmlTaskFunc func,
+                                   void *arg);
+
+/** Group of tasks which can be waited for */
+typedef struct _xmlTaskGroup xmlTaskGroup;
+
+XMLPUBFUN int
+			xmlThreadPoolSetSize(int nbWorkers);
+XMLPUBFUN void
+			xmlThreadPoolSetExecutor(xmlTaskExecutorFunc func,
+						 void *executor);
+XMLPUBFUN xmlTaskGroup *
+			xmlNewTaskGroup	(void);
+XMLPUBFUN int
+			xmlTaskGroupSubmit(xmlTaskGroup *group,
+					   xmlTaskFunc func,
+					   void *arg);
+XMLPUBFUN void
+			xmlTaskGroupJoin(xmlTaskGroup *group);
+XMLPUBFUN void
+			xmlFreeTaskGroup(xmlTaskGroup *group);
+
 /*
  * Library wide APIs.
  */
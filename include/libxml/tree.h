@@ -775,7 +775,9 @@ typedef enum {
     /** built for internal processing */
     XML_DOC_INTERNAL		= 1<<6,
     /** parsed or built HTML document */
-    XML_DOC_HTML		= 1<<7
+    XML_DOC_HTML		= 1<<7,
+    /** frozen for concurrent reads, see #xmlDocSetFrozen */
+    XML_DOC_FROZEN		= 1<<8
 } xmlDocProperties;
 
 /** XML or HTML document */
@@ -844,9 +846,39 @@ struct _xmlDoc {
     int             parseFlags;
     /** xmlDocProperties of the document */
     int             properties;
+    /**
+     * arena used to allocate nodes if the document was parsed
+     * with XML_PARSE_ARENA
+     */
+    void           *arena;
+    /** element name index, see #xmlDocSetNameIndex */
+    void           *nameIndex;
+    /** source text of elements, see #xmlCtxtSetSourceSpans */
+    void           *source;
 };
 
 
+/** Snapshot of a document, see #xmlNewDocSnapshot */
+typedef struct _xmlDocSnapshot xmlDocSnapshot;
+typedef xmlDocSnapshot *xmlDocSnapshotPtr;
+
+/** Builder appending nodes in document order, see #xmlNewTreeBuilder */
+typedef struct _xmlTreeBuilder xmlTreeBuilder;
+typedef xmlTreeBuilder *xmlTreeBuilderPtr;
+
+/**
+ * Options of #xmlNewTreeBuilder
+ */
+typedef enum {
+    /**
+     * Allocate new nodes from an arena owned by the document, see
+     * XML_PARSE_ARENA.
+     *
+     * @since 2.16.0
+     */
+    XML_TREE_BUILDER_ARENA = 1<<0
+} xmlTreeBuilderOption;
+
 /** Context for DOM wrapper operations */
 typedef struct _xmlDOMWrapCtxt xmlDOMWrapCtxt;
 typedef xmlDOMWrapCtxt *xmlDOMWrapCtxtPtr;
@@ -900,6 +932,19 @@ typedef void (*xmlRegisterNodeFunc) (xmlNode *node);
  */
 typedef void (*xmlDeregisterNodeFunc) (xmlNode *node);
 
+/**
+ * Callback for #xmlNodeWalkContent receiving a fragment of the
+ * string value of a node. `content` is not null-terminated.
+ *
+ * @param ctxt  user data
+ * @param content  the text fragment
+ * @param len  the length of the fragment in bytes
+ * @returns 0 to continue the walk or a non-zero value to stop it.
+ */
+typedef int (*xmlNodeContentFunc) (void *ctxt,
+                                   const xmlChar *content,
+                                   int len);
+
 /**
  * Macro for compatibility naming layer with libxml1. Maps
  * to "children."
@@ -994,6 +1039,13 @@ XMLPUBFUN xmlDoc *
 		xmlNewDoc		(const xmlChar *version);
 XMLPUBFUN void
 		xmlFreeDoc		(xmlDoc *cur);
+XMLPUBFUN int
+		xmlFreeDocIncremental	(xmlDoc *doc,
+					 int maxNodes);
+XMLPUBFUN void
+		xmlFreeDocAsync		(xmlDoc *doc);
+XMLPUBFUN void
+		xmlFreeDocAsyncWait	(void);
 XMLPUBFUN xmlAttr *
 		xmlNewDocProp		(xmlDoc *doc,
 					 const xmlChar *name,
@@ -1027,6 +1079,63 @@ XMLPUBFUN xmlDtd *
 XMLPUBFUN xmlDoc *
 		xmlCopyDoc		(xmlDoc *doc,
 					 int recursive);
+XMLPUBFUN xmlDocSnapshot *
+		xmlNewDocSnapshot	(xmlDoc *doc);
+XMLPUBFUN xmlDoc *
+		xmlDocSnapshotCopy	(xmlDocSnapshot *snap);
+XMLPUBFUN void
+		xmlFreeDocSnapshot	(xmlDocSnapshot *snap);
+XMLPUBFUN int
+		xmlDocSaveBinaryMemory	(xmlDoc *doc,
+					 xmlChar **mem,
+					 int *size);
+#ifdef LIBXML_OUTPUT_ENABLED
+XMLPUBFUN int
+		xmlDocSaveBinary	(xmlDoc *doc,
+					 const char *filename);
+#endif /* LIBXML_OUTPUT_ENABLED */
+XMLPUBFUN xmlDoc *
+		xmlDocLoadBinaryMemory	(const char *mem,
+					 int size);
+XMLPUBFUN xmlDoc *
+		xmlDocLoadBinary	(const char *filename);
+#ifdef LIBXML_OUTPUT_ENABLED
+XMLPUBFUN int
+		xmlDocSaveImage		(xmlDoc *doc,
+					 const char *filename);
+#endif /* LIBXML_OUTPUT_ENABLED */
+XMLPUBFUN xmlDoc *
+		xmlDocMapImage		(const char *filename);
+XMLPUBFUN xmlTreeBuilder *
+		xmlNewTreeBuilder	(xmlDoc *doc,
+					 xmlNode *parent,
+					 int options);
+XMLPUBFUN void
+		xmlFreeTreeBuilder	(xmlTreeBuilder *builder);
+XMLPUBFUN struct _xmlDict *
+		xmlTreeBuilderGetDict	(xmlTreeBuilder *builder);
+XMLPUBFUN int
+		xmlTreeBuilderDeclareNs	(xmlTreeBuilder *builder,
+					 const xmlChar *href,
+					 const xmlChar *prefix);
+XMLPUBFUN int
+		xmlTreeBuilderStartElement(xmlTreeBuilder *builder,
+					 int ns,
+					 const xmlChar *name);
+XMLPUBFUN int
+		xmlTreeBuilderEndElement(xmlTreeBuilder *builder);
+XMLPUBFUN int
+		xmlTreeBuilderAttribute	(xmlTreeBuilder *builder,
+					 int ns,
+					 const xmlChar *name,
+					 const xmlChar *value,
+					 int len);
+XMLPUBFUN int
+		xmlTreeBuilderText	(xmlTreeBuilder *builder,
+					 const xmlChar *content,
+					 int len);
+XMLPUBFUN int
+		xmlTreeBuilderFinish	(xmlTreeBuilder *builder);
 /*
  * Creating new nodes.
  */
@@ -1132,6 +1241,19 @@ XMLPUBFUN int
 XMLPUBFUN xmlNode *
 		xmlDocSetRootElement	(xmlDoc *doc,
 					 xmlNode *root);
+XMLPUBFUN int
+		xmlDocSetNameIndex	(xmlDoc *doc,
+					 int enable);
+XMLPUBFUN int
+		xmlDocSetFrozen		(xmlDoc *doc,
+					 int frozen);
+XMLPUBFUN const xmlChar *
+		xmlNodeGetSource	(const xmlNode *node,
+					 size_t *len);
+XMLPUBFUN void
+		xmlNodeMarkModified	(xmlNode *node);
+XMLPUBFUN void
+		xmlDocDiscardSource	(xmlDoc *doc);
 XMLPUBFUN void
 		xmlNodeSetName		(xmlNode *cur,
 					 const xmlChar *name);
@@ -1264,6 +1386,13 @@ XMLPUBFUN int
 					 int len);
 XMLPUBFUN xmlChar *
 		xmlNodeGetContent	(const xmlNode *cur);
+XMLPUBFUN const xmlChar *
+		xmlNodeBorrowContent	(const xmlNode *cur,
+					 xmlChar **mem);
+XMLPUBFUN int
+		xmlNodeWalkContent	(const xmlNode *cur,
+					 xmlNodeContentFunc func,
+					 void *ctxt);
 
 XMLPUBFUN int
 		xmlNodeBufGetContent	(xmlBuffer *buffer,
@@ -1473,6 +1602,12 @@ XMLPUBFUN xmlNode *
             xmlLastElementChild         (xmlNode *parent);
 XMLPUBFUN xmlNode *
             xmlPreviousElementSibling   (xmlNode *node);
+XMLPUBFUN xmlNode *
+            xmlNthChild                 (xmlNode *parent,
+                                         int n);
+XMLPUBFUN xmlNode *
+            xmlNthElementChild          (xmlNode *parent,
+                                         int n);
 
 XML_DEPRECATED
 XMLPUBFUN xmlRegisterNodeFunc
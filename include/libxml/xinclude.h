@@ -69,6 +69,9 @@ extern "C" {
 typedef struct _xmlXIncludeCtxt xmlXIncludeCtxt;
 typedef xmlXIncludeCtxt *xmlXIncludeCtxtPtr;
 
+/** Cache of included documents shared between contexts */
+typedef struct _xmlXIncludeCache xmlXIncludeCache;
+
 /*
  * standalone processing
  */
@@ -106,6 +109,12 @@ XMLPUBFUN void
 		xmlXIncludeSetResourceLoader(xmlXIncludeCtxt *ctxt,
 					 xmlResourceLoader loader,
 					 void *data);
+XMLPUBFUN int
+		xmlXIncludeSetParallel	(xmlXIncludeCtxt *ctxt,
+					 int nbThreads);
+XMLPUBFUN void
+		xmlXIncludeSetCache	(xmlXIncludeCtxt *ctxt,
+					 xmlXIncludeCache *cache);
 XMLPUBFUN int
 		xmlXIncludeGetLastError	(xmlXIncludeCtxt *ctxt);
 XMLPUBFUN void
@@ -113,6 +122,15 @@ XMLPUBFUN void
 XMLPUBFUN int
 		xmlXIncludeProcessNode	(xmlXIncludeCtxt *ctxt,
 					 xmlNode *tree);
+/*
+ * shared document cache
+ */
+XMLPUBFUN xmlXIncludeCache *
+		xmlXIncludeNewCache	(size_t maxSize);
+XMLPUBFUN void
+		xmlXIncludeCacheClear	(xmlXIncludeCache *cache);
+XMLPUBFUN void
+		xmlXIncludeFreeCache	(xmlXIncludeCache *cache);
 #ifdef __cplusplus
 }
 #endif
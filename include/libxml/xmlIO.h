@@ -140,6 +140,12 @@ struct _xmlParserInputBuffer {
     int error XML_DEPRECATED_MEMBER;
     /* amount consumed from raw */
     unsigned long rawconsumed XML_DEPRECATED_MEMBER;
+    /* size of the next read, grows on sequential input */
+    int readsize XML_DEPRECATED_MEMBER;
+    /* measure the time spent in conversion */
+    int convTiming XML_DEPRECATED_MEMBER;
+    /* seconds spent in conversion if measured */
+    double convTime XML_DEPRECATED_MEMBER;
 };
 
 
@@ -288,6 +294,26 @@ XMLPUBFUN const xmlChar *
 XMLPUBFUN size_t
         xmlOutputBufferGetSize          (xmlOutputBuffer *out);
 
+/* Output to a list of memory chunks */
+XMLPUBFUN xmlOutputBuffer *
+	xmlOutputBufferCreateChunked	(xmlCharEncodingHandler *encoder);
+XMLPUBFUN const xmlChar *
+	xmlOutputBufferNextChunk	(xmlOutputBuffer *out,
+					 void **iter,
+					 size_t *len);
+XMLPUBFUN xmlChar *
+	xmlOutputBufferFlatten		(xmlOutputBuffer *out,
+					 size_t *len);
+XMLPUBFUN long
+	xmlOutputBufferWriteChunksFd	(xmlOutputBuffer *out,
+					 int fd);
+
+/* Write from a separate thread */
+XMLPUBFUN int
+	xmlOutputBufferSetAsync		(xmlOutputBuffer *out,
+					 size_t size,
+					 int maxPending);
+
 XMLPUBFUN int
 	xmlOutputBufferWrite		(xmlOutputBuffer *out,
 					 int len,
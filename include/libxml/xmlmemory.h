@@ -182,6 +182,26 @@ XMLPUBFUN void
 	xmlMemFree	(void *ptr);
 XMLPUBFUN char *
 	xmlMemoryStrdup	(const char *str);
+/*
+ * Allocation profiler of the debug memory wrapper.
+ */
+XMLPUBFUN int
+	xmlMemProfileStart(void);
+XMLPUBFUN void
+	xmlMemProfileStop(void);
+XMLPUBFUN void
+	xmlMemProfileDump(FILE *fp);
+/*
+ * Pooled small-object allocator.
+ */
+XMLPUBFUN void *
+	xmlPoolMalloc	(size_t size) LIBXML_ATTR_ALLOC_SIZE(1);
+XMLPUBFUN void *
+	xmlPoolRealloc	(void *ptr, size_t size);
+XMLPUBFUN void
+	xmlPoolFree	(void *ptr);
+XMLPUBFUN char *
+	xmlPoolStrdup	(const char *str);
 XML_DEPRECATED
 XMLPUBFUN void *
 	xmlMallocLoc	(size_t size, const char *file, int line) LIBXML_ATTR_ALLOC_SIZE(1);
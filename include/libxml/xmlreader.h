@@ -116,6 +116,24 @@ typedef enum {
 typedef struct _xmlTextReader xmlTextReader;
 typedef xmlTextReader *xmlTextReaderPtr;
 
+/**
+ * An attribute of the current node returned by
+ * #xmlTextReaderGetAttributes.
+ */
+typedef struct _xmlTextReaderAttr xmlTextReaderAttr;
+struct _xmlTextReaderAttr {
+    /** local name */
+    const xmlChar *localname;
+    /** namespace prefix or NULL */
+    const xmlChar *prefix;
+    /** namespace URI or NULL */
+    const xmlChar *URI;
+    /** value, 0-terminated */
+    const xmlChar *value;
+    /** length of the value in bytes */
+    int len;
+};
+
 /*
  * Constructors & Destructor
  */
@@ -137,6 +155,12 @@ XMLPUBFUN void
                    unsigned maxAmpl);
 XMLPUBFUN const xmlError *
             xmlTextReaderGetLastError(xmlTextReader *reader);
+XMLPUBFUN int
+            xmlTextReaderSetFlat(xmlTextReader *reader, int flat);
+XMLPUBFUN int
+            xmlTextReaderSetPipelined(xmlTextReader *reader, int pipelined);
+XMLPUBFUN int
+            xmlTextReaderSetPreservePrune(xmlTextReader *reader, int prune);
 
 /*
  * Iterators
@@ -162,6 +186,9 @@ XMLPUBFUN int
  */
 XMLPUBFUN int
 			xmlTextReaderAttributeCount(xmlTextReader *reader);
+XMLPUBFUN int
+			xmlTextReaderGetAttributes(xmlTextReader *reader,
+						   const xmlTextReaderAttr **attrs);
 XMLPUBFUN int
 			xmlTextReaderDepth	(xmlTextReader *reader);
 XMLPUBFUN int
@@ -77,6 +77,12 @@ XML_DEPRECATED
 XMLPUBFUN void
 		    xmlRegFreeExecCtxt	(xmlRegExecCtxt *exec);
 XML_DEPRECATED
+XMLPUBFUN int
+		    xmlRegExecReset	(xmlRegExecCtxt *exec,
+					 xmlRegexp *comp,
+					 xmlRegExecCallbacks callback,
+					 void *data);
+XML_DEPRECATED
 XMLPUBFUN int
 		    xmlRegExecPushString(xmlRegExecCtxt *exec,
 					 const xmlChar *value,
@@ -83,7 +83,17 @@ typedef enum {
      *
      * @since 2.14
      */
-    XML_SAVE_INDENT     = 1<<10
+    XML_SAVE_INDENT     = 1<<10,
+    /**
+     * Compute the exact size of the output with a measuring pass
+     * before serializing, so that the buffer of #xmlSaveToBuffer
+     * is grown only once. This trades CPU time for fewer
+     * reallocations and a lower peak memory usage. Has no effect
+     * on other targets.
+     *
+     * @since 2.16.0
+     */
+    XML_SAVE_MEASURE    = 1<<11
 } xmlSaveOption;
 
 /** XML and HTML serializer */
@@ -124,9 +134,21 @@ XMLPUBFUN int
 		xmlSaveClose		(xmlSaveCtxt *ctxt);
 XMLPUBFUN xmlParserErrors
 		xmlSaveFinish		(xmlSaveCtxt *ctxt);
+XMLPUBFUN xmlParserErrors
+		xmlSaveCtxtReset	(xmlSaveCtxt *ctxt,
+					 xmlOutputWriteCallback iowrite,
+					 xmlOutputCloseCallback ioclose,
+					 void *ioctx);
+XMLPUBFUN xmlParserErrors
+		xmlSaveCtxtResetBuffer	(xmlSaveCtxt *ctxt,
+					 xmlBuffer *buffer);
 XMLPUBFUN int
 		xmlSaveSetIndentString	(xmlSaveCtxt *ctxt,
 					 const char *indent);
+XMLPUBFUN int
+		xmlSaveSetParallel	(xmlSaveCtxt *ctxt,
+					 int nbThreads,
+					 int minNodes);
 XML_DEPRECATED
 XMLPUBFUN int
 		xmlSaveSetEscape	(xmlSaveCtxt *ctxt,
@@ -83,7 +83,13 @@ typedef enum {
 	* xsi:noNamespaceSchemaLocation
 */
 
-/** XML schema */
+/**
+ * A compiled XML schema.
+ *
+ * A schema isn't modified by validation. It can be used by any
+ * number of validation contexts in multiple threads at the same
+ * time, as long as it isn't freed while in use.
+ */
 typedef struct _xmlSchema xmlSchema;
 typedef xmlSchema *xmlSchemaPtr;
 
@@ -115,6 +121,47 @@ typedef xmlSchemaParserCtxt *xmlSchemaParserCtxtPtr;
 typedef struct _xmlSchemaValidCtxt xmlSchemaValidCtxt;
 typedef xmlSchemaValidCtxt *xmlSchemaValidCtxtPtr;
 
+/** A pool of reusable schema validation contexts */
+typedef struct _xmlSchemaValidCtxtPool xmlSchemaValidCtxtPool;
+
+/**
+ * Totals collected by a profiled schema validation context, see
+ * #xmlSchemaValidCtxtSetProfile. Times are CPU seconds.
+ */
+typedef struct {
+    /** Number of elements validated */
+    unsigned long elements;
+    /** Number of attributes validated */
+    unsigned long attributes;
+    /** Number of values checked against simple types */
+    unsigned long simpleChecks;
+    /** Time spent checking values against simple types */
+    double simpleTime;
+    /** Number of strings pushed to content model automata */
+    unsigned long automatonPushes;
+    /** Time spent in content model automata */
+    double automatonTime;
+    /** Number of identity-constraint selector and field evaluations */
+    unsigned long idcEvaluations;
+    /** Time spent evaluating identity-constraints */
+    double idcTime;
+    /** Number of elements and attributes matched against wildcards */
+    unsigned long wildcards;
+    /** Time spent processing wildcards */
+    double wildcardTime;
+} xmlSchemaValidStats;
+
+/**
+ * A value kept by a schema validation context, see
+ * #xmlSchemaValidCtxtKeepValues.
+ */
+typedef struct {
+    /** The element or attribute node */
+    xmlNode *node;
+    /** The value computed from the node's content */
+    struct _xmlSchemaVal *value;
+} xmlSchemaNodeValue;
+
 /**
  * A schemas validation locator, a callback called by the validator.
  * This is used when file or node information are not available
@@ -159,6 +206,12 @@ XMLPUBFUN void
 	    xmlSchemaSetResourceLoader	(xmlSchemaParserCtxt *ctxt,
 					 xmlResourceLoader loader,
 					 void *data);
+XMLPUBFUN int
+	    xmlSchemaSetParserLazyImports(xmlSchemaParserCtxt *ctxt,
+					 int lazy);
+XMLPUBFUN int
+	    xmlSchemaSetParserThreads	(xmlSchemaParserCtxt *ctxt,
+					 int nbThreads);
 XMLPUBFUN int
 	    xmlSchemaIsValid		(xmlSchemaValidCtxt *ctxt);
 
@@ -166,6 +219,20 @@ XMLPUBFUN xmlSchema *
 	    xmlSchemaParse		(xmlSchemaParserCtxt *ctxt);
 XMLPUBFUN void
 	    xmlSchemaFree		(xmlSchema *schema);
+#ifdef LIBXML_OUTPUT_ENABLED
+XMLPUBFUN int
+	    xmlSchemaSave		(xmlSchema *schema,
+					 const char *filename);
+#endif /* LIBXML_OUTPUT_ENABLED */
+XMLPUBFUN int
+	    xmlSchemaSaveMemory		(xmlSchema *schema,
+					 xmlChar **mem,
+					 int *size);
+XMLPUBFUN xmlSchema *
+	    xmlSchemaLoad		(const char *filename);
+XMLPUBFUN xmlSchema *
+	    xmlSchemaLoadMemory		(const char *mem,
+					 int size);
 #ifdef LIBXML_DEBUG_ENABLED
 XMLPUBFUN void
 	    xmlSchemaDump		(FILE *output,
@@ -196,14 +263,64 @@ XMLPUBFUN void
 	                                 const char *filename);
 XMLPUBFUN int
 	    xmlSchemaValidCtxtGetOptions(xmlSchemaValidCtxt *ctxt);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtSetMaxMemory(xmlSchemaValidCtxt *ctxt,
+					 size_t maxMem);
+XMLPUBFUN size_t
+	    xmlSchemaValidCtxtGetMemoryUsed(xmlSchemaValidCtxt *ctxt);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtSetErrorPolicy(xmlSchemaValidCtxt *ctxt,
+					 int maxErrors,
+					 int maxPerCode,
+					 int dedup);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtGetErrorCount(xmlSchemaValidCtxt *ctxt,
+					 int code,
+					 int nodeType);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtSetParallel(xmlSchemaValidCtxt *ctxt,
+					 int nbThreads,
+					 int minNodes);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtSetProfile(xmlSchemaValidCtxt *ctxt,
+					 int enable);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtGetStats	(xmlSchemaValidCtxt *ctxt,
+					 xmlSchemaValidStats *stats);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtKeepValues(xmlSchemaValidCtxt *ctxt,
+					 int keep);
+XMLPUBFUN int
+	    xmlSchemaValidCtxtGetValues	(xmlSchemaValidCtxt *ctxt,
+					 const xmlSchemaNodeValue **values);
+#ifdef LIBXML_DEBUG_ENABLED
+XMLPUBFUN void
+	    xmlSchemaValidCtxtDumpProfile(FILE *output,
+					 xmlSchemaValidCtxt *ctxt);
+#endif /* LIBXML_DEBUG_ENABLED */
 
 XMLPUBFUN xmlSchemaValidCtxt *
 	    xmlSchemaNewValidCtxt	(xmlSchema *schema);
 XMLPUBFUN void
 	    xmlSchemaFreeValidCtxt	(xmlSchemaValidCtxt *ctxt);
+XMLPUBFUN xmlSchemaValidCtxtPool *
+	    xmlSchemaNewValidCtxtPool	(xmlSchema *schema,
+					 int maxSize);
+XMLPUBFUN void
+	    xmlSchemaFreeValidCtxtPool	(xmlSchemaValidCtxtPool *pool);
+XMLPUBFUN xmlSchemaValidCtxt *
+	    xmlSchemaValidCtxtPoolAcquire(xmlSchemaValidCtxtPool *pool);
+XMLPUBFUN void
+	    xmlSchemaValidCtxtPoolRelease(xmlSchemaValidCtxtPool *pool,
+					 xmlSchemaValidCtxt *ctxt);
 XMLPUBFUN int
 	    xmlSchemaValidateDoc	(xmlSchemaValidCtxt *ctxt,
 					 xmlDoc *instance);
+XMLPUBFUN int
+	    xmlSchemaRevalidateDoc	(xmlSchemaValidCtxt *ctxt,
+					 xmlDoc *doc,
+					 xmlNode **nodes,
+					 int nbNodes);
 XMLPUBFUN int
             xmlSchemaValidateOneElement (xmlSchemaValidCtxt *ctxt,
 			                 xmlNode *elem);
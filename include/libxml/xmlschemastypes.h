@@ -118,6 +118,8 @@ XMLPUBFUN int
 XMLPUBFUN int
 		xmlSchemaGetCanonValue		(xmlSchemaVal *val,
 						 const xmlChar **retValue);
+XMLPUBFUN const xmlChar *
+		xmlSchemaValueGetCanon		(xmlSchemaVal *val);
 XMLPUBFUN int
 		xmlSchemaGetCanonValueWhtsp	(xmlSchemaVal *val,
 						 const xmlChar **retValue,
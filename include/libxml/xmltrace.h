@@ -0,0 +1,99 @@
+/**
+ * @file
+ *
+ * @brief Tracing hooks
+ *
+ * A process-wide callback reporting the main phases of parsing,
+ * validation, XPath evaluation and serialization, with byte counts
+ * and durations.
+ *
+ * On systems providing `<sys/sdt.h>`, the same points are compiled in
+ * as USDT probes of provider `libxml2`, which tools like bpftrace or
+ * perf can attach to without a handler being registered. Phases with
+ * a duration have a pair of probes named `<phase>_start` and
+ * `<phase>_done`:
+ *
+ * - `doc_start(url)`, `doc_done(url, bytes)`
+ * - `entity_load_start(url)`, `entity_load_done(url, bytes)`
+ * - `dtd_load_start(url)`, `dtd_load_done(url, bytes)`
+ * - `schema_load_start(url)`, `schema_load_done(url, bytes)`
+ * - `xpath_compile_start(expr)`, `xpath_compile_done(expr, bytes)`
+ * - `xpath_eval_start(expr)`, `xpath_eval_done(expr, bytes)`
+ * - `valid_start(kind)`, `valid_done(kind, bytes)`
+ * - `input_grow(url, bytes)`, `save_flush(url, bytes)`
+ *
+ * @copyright See Copyright for the status of this software.
+ */
+
+#ifndef __XML_TRACE_H__
+#define __XML_TRACE_H__
+
+#include <libxml/xmlversion.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Traced events
+ */
+typedef enum {
+    /** Start of parsing a document */
+    XML_TRACE_DOC_START = 1,
+    /** End of parsing a document, bytes consumed */
+    XML_TRACE_DOC_END,
+    /** Bytes read from an input source */
+    XML_TRACE_INPUT_GROW,
+    /** An external entity or resource was loaded */
+    XML_TRACE_ENTITY_LOAD,
+    /** An external DTD subset was loaded and parsed */
+    XML_TRACE_DTD_LOAD,
+    /** A schema (XSD or Relax-NG) was parsed */
+    XML_TRACE_SCHEMA_LOAD,
+    /** An XPath expression was compiled */
+    XML_TRACE_XPATH_COMPILE,
+    /** An XPath expression was evaluated */
+    XML_TRACE_XPATH_EVAL,
+    /** Start of validating a document */
+    XML_TRACE_VALID_START,
+    /** End of validating a document */
+    XML_TRACE_VALID_END,
+    /** Bytes flushed by a serializer output buffer */
+    XML_TRACE_SAVE_FLUSH
+} xmlTraceEvent;
+
+/**
+ * Information passed to a trace handler
+ */
+typedef struct {
+    /** the event */
+    xmlTraceEvent event;
+    /**
+     * URL, XPath expression or kind of validation ("dtd", "xsd",
+     * "relaxng"), or NULL
+     */
+    const char *name;
+    /** number of bytes processed or -1 if unknown */
+    long bytes;
+    /** duration in seconds for end events, 0 otherwise */
+    double duration;
+} xmlTraceInfo;
+
+/**
+ * Trace handler. Can be called from any thread and must not call
+ * back into the library.
+ *
+ * @param userData  user data passed to #xmlTraceSetHandler
+ * @param info  the event
+ */
+typedef void (*xmlTraceFunc)(void *userData, const xmlTraceInfo *info);
+
+XMLPUBFUN void
+	xmlTraceSetHandler	(xmlTraceFunc handler,
+				 void *userData);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __XML_TRACE_H__ */
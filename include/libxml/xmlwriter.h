@@ -30,6 +30,19 @@ extern "C" {
     typedef struct _xmlTextWriter xmlTextWriter;
     typedef xmlTextWriter *xmlTextWriterPtr;
 
+    /**
+     * A simple element for #xmlTextWriterWriteElements.
+     */
+    typedef struct _xmlTextWriterElement xmlTextWriterElement;
+    struct _xmlTextWriterElement {
+        /** element name */
+        const xmlChar *name;
+        /** NULL-terminated array of attribute names and values or NULL */
+        const xmlChar *const *attrs;
+        /** text content or NULL for an empty element */
+        const xmlChar *text;
+    };
+
 /*
  * Constructors & Destructor
  */
@@ -144,6 +157,10 @@ extern "C" {
                                                       namespaceURI,
                                                       const xmlChar *
                                                       content);
+    XMLPUBFUN int
+        xmlTextWriterWriteElements(xmlTextWriter *writer,
+                                   const xmlTextWriterElement *elems,
+                                   int nbElems);
 
 /*
  * Text
@@ -473,6 +490,9 @@ extern "C" {
     XMLPUBFUN int
         xmlTextWriterSetQuoteChar(xmlTextWriter *writer, xmlChar quotechar);
 
+    XMLPUBFUN int
+        xmlTextWriterSetTrusted(xmlTextWriter *writer, int trusted);
+
 
 /*
  * misc
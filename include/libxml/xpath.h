@@ -72,7 +72,9 @@ typedef enum {
     XPATH_STACK_ERROR,
     XPATH_FORBID_VARIABLE_ERROR,
     XPATH_OP_LIMIT_EXCEEDED,
-    XPATH_RECURSION_LIMIT_EXCEEDED
+    XPATH_RECURSION_LIMIT_EXCEEDED,
+    XPATH_TIME_LIMIT_EXCEEDED,
+    XPATH_CANCELLED
 } xmlXPathError;
 
 /** XPath node set */
@@ -239,6 +241,11 @@ typedef xmlXPathFunction (*xmlXPathFuncLookupFunc) (void *ctxt,
  * forbid variables in expression
  */
 #define XML_XPATH_NOVAR	  (1<<1)
+/**
+ * count evaluations, visited nodes and elapsed time of every operation
+ * of compiled expressions, see xmlXPathDebugDumpProfile
+ */
+#define XML_XPATH_PROFILE (1<<2)
 
 /**
  * Expression evaluation occurs with respect to a context.
@@ -354,12 +361,35 @@ struct _xmlXPathContext {
     unsigned long opLimit;
     unsigned long opCount;
     int depth;
+
+    /* Memory budget */
+    struct _xmlMemBudget *memBudget;
+
+    /* Cache of compiled expressions */
+    void *exprCache;
+
+    /* Parallel evaluation of predicates */
+    int parallelThreads;
+    int parallelMinNodes;
+
+    /* Time limit in milliseconds and deadline of the evaluation */
+    unsigned long timeLimit;
+    unsigned long deadline;
+    /* Evaluation is cancelled once this is non-zero */
+    const volatile int *cancel;
+
+    /* Named key indexes, see xmlXPathRegisterKey */
+    void *keys;
 };
 
 /** Compiled XPath expression */
 typedef struct _xmlXPathCompExpr xmlXPathCompExpr;
 typedef xmlXPathCompExpr *xmlXPathCompExprPtr;
 
+/** Iterator over the result of a compiled XPath expression */
+typedef struct _xmlXPathIterator xmlXPathIterator;
+typedef xmlXPathIterator *xmlXPathIteratorPtr;
+
 /**
  * An XPath parser context. It contains pure parsing information,
  * an xmlXPathContext, and the stack of objects.
@@ -395,6 +425,11 @@ struct _xmlXPathParserContext {
 
     /* always zero for compatibility */
     int              valueFrame;
+
+    /* values of context independent subexpressions */
+    void *invariants;
+    /* counters of a profiled evaluation, merged into the expression */
+    void *profile;
 };
 
 /************************************************************************
@@ -518,6 +553,38 @@ XMLPUBFUN int
 				            int active,
 					    int value,
 					    int options);
+XMLPUBFUN void
+		    xmlXPathSetThreadCacheSize(int maxObjects);
+XMLPUBFUN int
+		    xmlXPathContextSetMaxMemory(xmlXPathContext *ctxt,
+					    size_t maxMem);
+XMLPUBFUN size_t
+		    xmlXPathContextGetMemoryUsed(xmlXPathContext *ctxt);
+XMLPUBFUN int
+		    xmlXPathContextSetExprCache(xmlXPathContext *ctxt,
+					    int maxEntries);
+XMLPUBFUN int
+		    xmlXPathContextSetParallel(xmlXPathContext *ctxt,
+					    int nbThreads,
+					    int minNodes);
+XMLPUBFUN void
+		    xmlXPathContextSetTimeLimit(xmlXPathContext *ctxt,
+					    unsigned long ms);
+XMLPUBFUN void
+		    xmlXPathContextSetCancelFlag(xmlXPathContext *ctxt,
+					    const volatile int *flag);
+XMLPUBFUN int
+		    xmlXPathRegisterKey		(xmlXPathContext *ctxt,
+					    const xmlChar *name,
+					    const xmlChar *match,
+					    const xmlChar *use);
+XMLPUBFUN xmlXPathObject *
+		    xmlXPathKeyLookup		(xmlXPathContext *ctxt,
+					    xmlDoc *doc,
+					    const xmlChar *name,
+					    const xmlChar *value);
+XMLPUBFUN void
+		    xmlXPathClearKeyIndexes	(xmlXPathContext *ctxt);
 /**
  * Evaluation functions.
  */
@@ -553,6 +620,19 @@ XMLPUBFUN xmlXPathObject *
 XMLPUBFUN int
 		    xmlXPathCompiledEvalToBoolean(xmlXPathCompExpr *comp,
 						 xmlXPathContext *ctxt);
+XMLPUBFUN xmlXPathIterator *
+		    xmlXPathCompiledIterate	(xmlXPathCompExpr *comp,
+						 xmlXPathContext *ctxt);
+XMLPUBFUN int
+		    xmlXPathIteratorNext	(xmlXPathIterator *iter,
+						 xmlNode **node);
+XMLPUBFUN void
+		    xmlXPathFreeIterator	(xmlXPathIterator *iter);
+XMLPUBFUN int
+		    xmlXPathCompiledEvalMulti	(xmlXPathCompExpr **comps,
+						 int nbComps,
+						 xmlXPathContext *ctxt,
+						 xmlXPathObject **results);
 XMLPUBFUN void
 		    xmlXPathFreeCompExpr	(xmlXPathCompExpr *comp);
 
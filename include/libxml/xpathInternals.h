@@ -344,6 +344,10 @@ XMLPUBFUN void
 	    xmlXPathDebugDumpCompExpr(FILE *output,
 					 xmlXPathCompExpr *comp,
 					 int depth);
+XMLPUBFUN void
+	    xmlXPathDebugDumpProfile(FILE *output,
+					 xmlXPathCompExpr *comp,
+					 int depth);
 #endif
 /**
  * NodeSet handling.
@@ -32,6 +32,12 @@
 extern "C" {
 #endif
 
+/**
+ * A compiled XPointer expression
+ */
+typedef struct _xmlXPtrCompExpr xmlXPtrCompExpr;
+typedef xmlXPtrCompExpr *xmlXPtrCompExprPtr;
+
 /*
  * Functions.
  */
@@ -43,6 +49,14 @@ XMLPUBFUN xmlXPathContext *
 XMLPUBFUN xmlXPathObject *
 		    xmlXPtrEval			(const xmlChar *str,
 						 xmlXPathContext *ctx);
+XMLPUBFUN xmlXPtrCompExpr *
+		    xmlXPtrCompile		(const xmlChar *str,
+						 xmlXPathContext *ctx);
+XMLPUBFUN xmlXPathObject *
+		    xmlXPtrCompiledEval		(xmlXPtrCompExpr *comp,
+						 xmlXPathContext *ctx);
+XMLPUBFUN void
+		    xmlXPtrFreeCompExpr		(xmlXPtrCompExpr *comp);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,190 @@
+#ifndef XML_BINARY_H_PRIVATE__
+#define XML_BINARY_H_PRIVATE__
+
+#include <string.h>
+
+#include <libxml/xmlstring.h>
+#include <libxml/tree.h>
+
+#include "private/buf.h"
+
+/*
+ * Helpers for the little-endian binary formats of precompiled
+ * objects, see xmlSchemaSave. Writers append to an xmlBuf whose
+ * errors are sticky and checked once at the end. Readers never
+ * read past the end of the input and flag an error instead.
+ */
+
+typedef struct {
+    const unsigned char *cur;
+    const unsigned char *end;
+    int error;
+} xmlBinReader;
+
+static XML_INLINE void
+xmlBinWriteInt(xmlBuf *buf, int val) {
+    unsigned int u = (unsigned int) val;
+    unsigned char bytes[4];
+
+    bytes[0] = u & 0xFF;
+    bytes[1] = (u >> 8) & 0xFF;
+    bytes[2] = (u >> 16) & 0xFF;
+    bytes[3] = (u >> 24) & 0xFF;
+    xmlBufAdd(buf, bytes, 4);
+}
+
+static XML_INLINE void
+xmlBinWriteLong(xmlBuf *buf, long val) {
+    unsigned long long u = (unsigned long long) (long long) val;
+
+    xmlBinWriteInt(buf, (int) (u & 0xFFFFFFFFu));
+    xmlBinWriteInt(buf, (int) (u >> 32));
+}
+
+static XML_INLINE void
+xmlBinWriteDouble(xmlBuf *buf, double val) {
+    unsigned long long u;
+
+    memcpy(&u, &val, sizeof(u));
+    xmlBinWriteInt(buf, (int) (u & 0xFFFFFFFFu));
+    xmlBinWriteInt(buf, (int) (u >> 32));
+}
+
+/*
+ * Unsigned integers in 7-bit groups, low group first, for formats
+ * where most values are small.
+ */
+static XML_INLINE void
+xmlBinWriteVarint(xmlBuf *buf, unsigned int val) {
+    unsigned char bytes[5];
+    int n = 0;
+
+    while (val >= 0x80) {
+        bytes[n++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    bytes[n++] = val;
+    xmlBufAdd(buf, bytes, n);
+}
+
+/*
+ * Strings are written as their length followed by their bytes,
+ * NULL as length -1.
+ */
+static XML_INLINE void
+xmlBinWriteString(xmlBuf *buf, const xmlChar *str) {
+    if (str == NULL) {
+        xmlBinWriteInt(buf, -1);
+    } else {
+        int len = xmlStrlen(str);
+
+        xmlBinWriteInt(buf, len);
+        xmlBufAdd(buf, str, len);
+    }
+}
+
+static XML_INLINE int
+xmlBinReadInt(xmlBinReader *reader) {
+    const unsigned char *cur = reader->cur;
+
+    if (reader->end - cur < 4) {
+        reader->error = 1;
+        reader->cur = reader->end;
+        return(0);
+    }
+    reader->cur += 4;
+    return((int) ((unsigned int) cur[0] |
+                  ((unsigned int) cur[1] << 8) |
+                  ((unsigned int) cur[2] << 16) |
+                  ((unsigned int) cur[3] << 24)));
+}
+
+static XML_INLINE unsigned int
+xmlBinReadVarint(xmlBinReader *reader) {
+    unsigned int val = 0;
+    int shift = 0;
+
+    while (reader->cur < reader->end) {
+        unsigned int c = *reader->cur++;
+
+        if ((shift == 28) && (c > 0x0F))
+            break;
+        val |= (c & 0x7F) << shift;
+        if (c < 0x80)
+            return(val);
+        shift += 7;
+    }
+    reader->error = 1;
+    reader->cur = reader->end;
+    return(0);
+}
+
+static XML_INLINE unsigned long long
+xmlBinReadU64(xmlBinReader *reader) {
+    unsigned long long lo, hi;
+
+    lo = (unsigned int) xmlBinReadInt(reader);
+    hi = (unsigned int) xmlBinReadInt(reader);
+    return(lo | (hi << 32));
+}
+
+static XML_INLINE long
+xmlBinReadLong(xmlBinReader *reader) {
+    return((long) (long long) xmlBinReadU64(reader));
+}
+
+static XML_INLINE double
+xmlBinReadDouble(xmlBinReader *reader) {
+    unsigned long long u = xmlBinReadU64(reader);
+    double val;
+
+    memcpy(&val, &u, sizeof(val));
+    return(val);
+}
+
+/*
+ * Returns a pointer into the input and stores the length in `len`,
+ * or returns NULL for NULL strings and errors.
+ */
+static XML_INLINE const xmlChar *
+xmlBinReadString(xmlBinReader *reader, int *len) {
+    const unsigned char *ret;
+    int l = xmlBinReadInt(reader);
+
+    *len = 0;
+    if (l < 0) {
+        if (l != -1)
+            reader->error = 1;
+        return(NULL);
+    }
+    if (reader->end - reader->cur < l) {
+        reader->error = 1;
+        reader->cur = reader->end;
+        return(NULL);
+    }
+    ret = reader->cur;
+    reader->cur += l;
+    *len = l;
+    return(ret);
+}
+
+/*
+ * Returns a copy of the next string. Allocation failures are
+ * reported as errors of the reader.
+ */
+static XML_INLINE xmlChar *
+xmlBinReadStrdup(xmlBinReader *reader) {
+    const xmlChar *str;
+    xmlChar *ret;
+    int len;
+
+    str = xmlBinReadString(reader, &len);
+    if (str == NULL)
+        return(NULL);
+    ret = xmlStrndup(str, len);
+    if (ret == NULL)
+        reader->error = 1;
+    return(ret);
+}
+
+#endif /* XML_BINARY_H_PRIVATE__ */
@@ -1,8 +1,12 @@
 #ifndef XML_DICT_H_PRIVATE__
 #define XML_DICT_H_PRIVATE__
 
+#include <string.h>
+
 #include <libxml/dict.h>
 
+#include "memory.h"
+
 /*
  * Values are ANDed with 0xFFFFFFFF to support platforms where
  * unsigned is larger than 32 bits. With 32-bit unsigned values,
@@ -45,6 +49,160 @@
         h2 &= 0xFFFFFFFF; \
     } while (0)
 
+/*
+ * String hashing. By default, strings are hashed a byte at a time
+ * with GoodOAAT. Builds configured with the word-wise hash option
+ * (XML_WORDWISE_HASH) hash a word at a time instead on little-endian
+ * platforms with 64-bit multiplication and fall back to GoodOAAT
+ * elsewhere.
+ *
+ * Both variants are streaming hashes: the hash value only depends on
+ * the sequence of bytes, not on how it was split into calls. QName
+ * lookups rely on this to match entries added as "prefix:name".
+ */
+
+#if defined(XML_WORDWISE_HASH) && \
+    (defined(_M_X64) || defined(_M_ARM64) || \
+     (defined(__BYTE_ORDER__) && \
+      __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && \
+      defined(__SIZEOF_LONG_LONG__) && __SIZEOF_LONG_LONG__ == 8))
+  #define XML_HASH_WORDWISE
+#endif
+
+#ifdef XML_HASH_WORDWISE
+
+#define XML_HASH_K1 0x9E3779B97F4A7C15ULL
+#define XML_HASH_K2 0xC2B2AE3D27D4EB4FULL
+
+typedef struct {
+    unsigned long long h;
+    unsigned long long w;
+    size_t n;
+} xmlHashState;
+
+#define HASH_ROL64(x,n) ((x) << (n) | (x) >> (64 - (n)))
+
+#define HASH_MIX_WORD(st, word) \
+    do { \
+        (st)->h ^= (word); \
+        (st)->h *= XML_HASH_K1; \
+        (st)->h = HASH_ROL64((st)->h, 31); \
+    } while (0)
+
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE void
+xmlHashInit(xmlHashState *st, unsigned seed) {
+    st->h = ((unsigned long long) seed * XML_HASH_K2) ^ XML_HASH_K1;
+    st->w = 0;
+    st->n = 0;
+}
+
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE void
+xmlHashUpdateByte(xmlHashState *st, unsigned ch) {
+    st->w |= (unsigned long long) (ch & 0xFF) << (8 * (st->n & 7));
+    if ((++st->n & 7) == 0) {
+        HASH_MIX_WORD(st, st->w);
+        st->w = 0;
+    }
+}
+
+/*
+ * Hash at most `maxLen` bytes of a string, stopping at a NUL byte.
+ * Returns the number of bytes hashed.
+ */
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE size_t
+xmlHashUpdateString(xmlHashState *st, const xmlChar *str, size_t maxLen) {
+    const xmlChar *end;
+    const xmlChar *cur = str;
+    size_t len;
+
+    if (maxLen == SIZE_MAX) {
+        len = strlen((const char *) str);
+    } else {
+        end = memchr(str, 0, maxLen);
+        len = end ? (size_t) (end - str) : maxLen;
+    }
+    end = str + len;
+
+    while (((st->n & 7) != 0) && (cur < end))
+        xmlHashUpdateByte(st, *cur++);
+
+    while (end - cur >= 8) {
+        unsigned long long word;
+
+        memcpy(&word, cur, 8);
+        HASH_MIX_WORD(st, word);
+        st->n += 8;
+        cur += 8;
+    }
+
+    while (cur < end)
+        xmlHashUpdateByte(st, *cur++);
+
+    return(len);
+}
+
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE unsigned
+xmlHashFinish(xmlHashState *st) {
+    unsigned long long h;
+
+    if (st->n & 7)
+        HASH_MIX_WORD(st, st->w);
+    h = st->h ^ st->n;
+
+    /* MurmurHash3 finalizer */
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= XML_HASH_K2;
+    h ^= h >> 33;
+
+    return((unsigned) h & 0xFFFFFFFF);
+}
+
+#else /* XML_HASH_WORDWISE */
+
+typedef struct {
+    unsigned h1;
+    unsigned h2;
+} xmlHashState;
+
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE void
+xmlHashInit(xmlHashState *st, unsigned seed) {
+    HASH_INIT(st->h1, st->h2, seed);
+}
+
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE void
+xmlHashUpdateByte(xmlHashState *st, unsigned ch) {
+    HASH_UPDATE(st->h1, st->h2, ch);
+}
+
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE size_t
+xmlHashUpdateString(xmlHashState *st, const xmlChar *str, size_t maxLen) {
+    size_t i;
+
+    for (i = 0; i < maxLen && str[i]; i++) {
+        HASH_UPDATE(st->h1, st->h2, str[i]);
+    }
+
+    return(i);
+}
+
+ATTRIBUTE_NO_SANITIZE_INTEGER
+static XML_INLINE unsigned
+xmlHashFinish(xmlHashState *st) {
+    HASH_FINISH(st->h1, st->h2);
+    return(st->h2);
+}
+
+#endif /* XML_HASH_WORDWISE */
+
 typedef struct {
     unsigned hashValue;
     const xmlChar *name;
@@ -55,12 +213,35 @@ xmlInitDictInternal(void);
 XML_HIDDEN void
 xmlCleanupDictInternal(void);
 
+XML_HIDDEN int
+xmlDictIsShared(xmlDict *dict);
+XML_HIDDEN int
+xmlDictIsConcurrent(xmlDict *dict);
+XML_HIDDEN xmlDict *
+xmlDictNewView(xmlDict *dict);
+
 XML_HIDDEN unsigned
 xmlDictComputeHash(const xmlDict *dict, const xmlChar *string);
 XML_HIDDEN unsigned
 xmlDictCombineHash(unsigned v1, unsigned v2);
 XML_HIDDEN xmlHashedString
 xmlDictLookupHashed(xmlDict *dict, const xmlChar *name, int len);
+XML_HIDDEN void
+xmlDictHashStart(const xmlDict *dict, xmlHashState *st);
+XML_HIDDEN xmlHashedString
+xmlDictLookupHashedName(xmlDict *dict, const xmlChar *name, int len,
+                        unsigned hashValue);
+XML_HIDDEN unsigned long
+xmlDictGetLookups(xmlDict *dict);
+
+/*
+ * Namespace URI IDs are handed out to dictionaries in blocks of this
+ * size, see xmlDictNsId.
+ */
+#define XML_DICT_NS_ID_BLOCK 64
+
+XML_HIDDEN int
+xmlDictNsId(xmlDict *dict, const xmlChar *href, int update);
 
 XML_HIDDEN void
 xmlInitRandom(void);
@@ -6,6 +6,10 @@
 
 XML_HIDDEN void
 xmlInitEncodingInternal(void);
+XML_HIDDEN void
+xmlInitConvPoolInternal(void);
+XML_HIDDEN void
+xmlCleanupConvPoolInternal(void);
 
 XML_HIDDEN xmlCharEncError
 xmlEncInputChunk(xmlCharEncodingHandler *handler, unsigned char *out,
@@ -15,5 +19,10 @@ XML_HIDDEN xmlCharEncError
 xmlCharEncInput(xmlParserInputBuffer *input, size_t *sizeOut, int flush);
 XML_HIDDEN int
 xmlCharEncOutput(xmlOutputBuffer *output, int init);
+XML_HIDDEN int
+xmlCharEncIsSingleByte(const xmlCharEncodingHandler *handler);
+XML_HIDDEN int
+xmlCharEncOutputChar(const xmlCharEncodingHandler *handler, int c,
+                     char *out);
 
 #endif /* XML_ENC_H_PRIVATE__ */
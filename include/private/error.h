@@ -10,6 +10,46 @@
 
 struct _xmlNode;
 
+#define XML_ERR_RECORD_MAX_ARGS 8
+#define XML_ERR_RECORD_STR_SIZE 256
+
+/*
+ * An error whose message wasn't formatted yet. The arguments of the
+ * format string are kept by value, strings are copied into a small
+ * inline buffer.
+ */
+typedef struct {
+    int domain;
+    int code;
+    int level;
+    int line;
+    int col;
+    int int1;
+    /* offset of the file name in strings or -1 */
+    int file;
+    /* format string or NULL if the message is stored in strings */
+    const char *fmt;
+    int nbArgs;
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        const void *p;
+    } args[XML_ERR_RECORD_MAX_ARGS];
+    unsigned strUsed;
+    char strings[XML_ERR_RECORD_STR_SIZE];
+} xmlErrorRecord;
+
+/*
+ * The last errors of a parser context in deferred mode.
+ */
+typedef struct {
+    xmlErrorRecord *records;
+    int size;
+    /* number of errors recorded since the last reset */
+    unsigned long count;
+} xmlErrorRing;
+
 XML_HIDDEN int
 xmlIsCatastrophicError(int level, int code);
 
@@ -30,6 +70,52 @@ xmlRaiseError(xmlStructuredErrorFunc schannel, xmlGenericErrorFunc channel,
               const char *file, int line, const char *str1,
               const char *str2, const char *str3, int int1, int col,
               const char *msg, ...) LIBXML_ATTR_FORMAT(16,17);
+XML_HIDDEN void
+xmlErrorRecordInit(xmlErrorRecord *rec, int domain, int code,
+                   xmlErrorLevel level, const char *file, int line,
+                   int col, int int1, const char *fmt, va_list ap);
+XML_HIDDEN char *
+xmlErrorRecordFormat(const xmlErrorRecord *rec);
+XML_HIDDEN int
+xmlErrorRecordToError(const xmlErrorRecord *rec, void *ctxt,
+                      xmlError *err);
+XML_HIDDEN void
+xmlRaiseDeferredError(xmlStructuredErrorFunc schannel, void *data,
+                      void *ctxt, struct _xmlNode *node, int domain,
+                      int code, xmlErrorLevel level, int line, int int1,
+                      int col, xmlError *to);
+/*
+ * Limits on the errors reported by a context, see
+ * #xmlCtxtSetErrorPolicy.
+ */
+typedef struct {
+    int maxErrors;
+    int maxPerCode;
+    int dedup;
+    /* errors seen since the last reset */
+    int nbErrors;
+    /* set once maxErrors was reached */
+    int stopped;
+    /* hash table of counts by code and node type */
+    unsigned *keys;
+    unsigned *counts;
+    unsigned size;
+    unsigned used;
+} xmlErrorPolicy;
+
+XML_HIDDEN int
+xmlErrorPolicySet(xmlErrorPolicy **policy, int maxErrors, int maxPerCode,
+                  int dedup);
+XML_HIDDEN void
+xmlErrorPolicyFree(xmlErrorPolicy *policy);
+XML_HIDDEN void
+xmlErrorPolicyReset(xmlErrorPolicy *policy);
+XML_HIDDEN int
+xmlErrorPolicyCheck(xmlErrorPolicy *policy, int code, int nodeType,
+                    xmlErrorLevel level);
+XML_HIDDEN int
+xmlErrorPolicyCount(const xmlErrorPolicy *policy, int code, int nodeType);
+
 XML_HIDDEN void
 xmlGenericErrorDefaultFunc(void *ctx, const char *msg,
                            ...) LIBXML_ATTR_FORMAT(2,3);
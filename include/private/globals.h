@@ -1,6 +1,8 @@
 #ifndef XML_GLOBALS_H_PRIVATE__
 #define XML_GLOBALS_H_PRIVATE__
 
+#include "memory.h"
+
 XML_HIDDEN void
 xmlInitGlobalsInternal(void);
 XML_HIDDEN void
@@ -12,4 +14,12 @@ xmlGetLastErrorInternal(void);
 XML_HIDDEN unsigned *
 xmlGetLocalRngState(void);
 
+XML_HIDDEN xmlPoolCache *
+xmlGetLocalPoolCache(void);
+
+#ifdef LIBXML_XPATH_ENABLED
+XML_HIDDEN void **
+xmlGetLocalXPathCache(void);
+#endif
+
 #endif /* XML_GLOBALS_H_PRIVATE__ */
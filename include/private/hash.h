@@ -0,0 +1,17 @@
+#ifndef XML_HASH_H_PRIVATE__
+#define XML_HASH_H_PRIVATE__
+
+#include <libxml/hash.h>
+
+XML_HIDDEN int
+xmlHashIndexInterned(xmlHashTable *hash);
+XML_HIDDEN void *
+xmlHashLookupInterned(xmlHashTable *hash, const xmlChar *key);
+XML_HIDDEN void *
+xmlHashLookupInterned2(xmlHashTable *hash, const xmlChar *key,
+                       const xmlChar *key2);
+XML_HIDDEN void *
+xmlHashLookupInterned3(xmlHashTable *hash, const xmlChar *key,
+                       const xmlChar *key2, const xmlChar *key3);
+
+#endif /* XML_HASH_H_PRIVATE__ */
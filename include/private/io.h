@@ -3,6 +3,7 @@
 
 #include <libxml/encoding.h>
 #include <libxml/tree.h>
+#include <libxml/xmlIO.h>
 #include <libxml/xmlversion.h>
 
 #ifndef SIZE_MAX
@@ -23,6 +24,7 @@
 #define XML_ESCAPE_NON_ASCII        (1u << 1)
 #define XML_ESCAPE_HTML             (1u << 2)
 #define XML_ESCAPE_QUOT             (1u << 3)
+#define XML_ESCAPE_NO_COPY          (1u << 4)
 
 XML_HIDDEN xmlChar *
 xmlEscapeText(const xmlChar *text, int flags);
@@ -52,6 +54,20 @@ xmlNewInputBufferMemory(const void *mem, size_t size,
 XML_HIDDEN xmlParserErrors
 xmlInputFromFd(xmlParserInputBuffer *buf, int fd, xmlParserInputFlags flags);
 
+XML_HIDDEN xmlParserErrors
+xmlMapFile(const char *filename, void *addr, int writable, void **map,
+           size_t *size);
+XML_HIDDEN void
+xmlUnmapFile(void *map, size_t size);
+
+XML_HIDDEN int
+xmlParserInputBufferTakeContent(xmlParserInputBuffer *in, xmlChar **text,
+                                size_t *size, xmlInputCloseCallback *release,
+                                void **releaseCtxt);
+XML_HIDDEN int
+xmlParserInputBufferGetMemory(xmlParserInputBuffer *in, const xmlChar **mem,
+                              size_t *size);
+
 #ifdef LIBXML_OUTPUT_ENABLED
 XML_HIDDEN void
 xmlOutputBufferWriteQuotedString(xmlOutputBuffer *buf,
@@ -17,6 +17,65 @@ xmlInitMemoryInternal(void);
 XML_HIDDEN void
 xmlCleanupMemoryInternal(void);
 
+typedef struct _xmlArena xmlArena;
+
+XML_HIDDEN xmlArena *
+xmlArenaCreate(void);
+XML_HIDDEN void
+xmlArenaFree(xmlArena *arena);
+XML_HIDDEN void *
+xmlArenaAlloc(xmlArena *arena, size_t size);
+XML_HIDDEN unsigned char *
+xmlArenaStrndup(xmlArena *arena, const unsigned char *str, int len);
+XML_HIDDEN int
+xmlArenaOwns(const xmlArena *arena, const void *ptr);
+
+/*
+ * Number of size classes of the pool allocator, in steps of 16 bytes
+ */
+#define XML_POOL_CLASSES 16
+
+/*
+ * Per-thread state of the pool allocator
+ */
+typedef struct {
+    void *freeList[XML_POOL_CLASSES];
+    unsigned count[XML_POOL_CLASSES];
+    /* a full batch of free blocks or NULL */
+    void *spare[XML_POOL_CLASSES];
+    /* unused part of the current slab */
+    char *cur;
+    char *end;
+    /* statistics not yet added to the global counters */
+    long sizeDelta;
+    long blocksDelta;
+} xmlPoolCache;
+
+XML_HIDDEN void
+xmlPoolCacheRelease(xmlPoolCache *cache);
+
+/*
+ * Memory budget of a parser, XPath or validation context
+ */
+struct _xmlMemBudget {
+    size_t max;
+    size_t used;
+    int exceeded;
+};
+
+XML_HIDDEN int
+xmlMemBudgetSet(struct _xmlMemBudget **budget, size_t max);
+XML_HIDDEN void
+xmlMemBudgetReset(struct _xmlMemBudget *budget);
+XML_HIDDEN struct _xmlMemBudget *
+xmlMemBudgetEnter(struct _xmlMemBudget *budget);
+XML_HIDDEN void
+xmlMemBudgetLeave(struct _xmlMemBudget *prev);
+XML_HIDDEN struct _xmlMemBudget *
+xmlMemBudgetSuspend(void);
+XML_HIDDEN int
+xmlMemBudgetExceeded(void);
+
 /**
  * @array:  pointer to array
  * @capacity:  pointer to capacity (in/out)
@@ -40,9 +40,27 @@
 #define XML_INPUT_ENCODING_ERROR    (1u << 5)
 #define XML_INPUT_PROGRESSIVE       (1u << 6)
 #define XML_INPUT_MARKUP_DECL       (1u << 7)
+#define XML_INPUT_KEEP_SOURCE       (1u << 8)
+#define XML_INPUT_INTERNAL_ENTITY   (1u << 9)
+#define XML_INPUT_LAZY_LINES        (1u << 10)
+
+/*
+ * Flags in partialText
+ */
+#define XML_TEXT_MORE               (1u << 0)
+#define XML_TEXT_CONTINUED          (1u << 1)
+
+/*
+ * Size of chunks of CDATA sections in chunked text mode
+ */
+#define XML_TEXT_CHUNK_SIZE         65536
 
 #define PARSER_STOPPED(ctxt) ((ctxt)->disableSAX > 1)
 
+#define PARSER_INTERRUPTED(ctxt) \
+    ((((ctxt)->stopRequested) || ((ctxt)->timeLimit != 0)) && \
+     (xmlParserCheckInterrupt(ctxt) < 0))
+
 #define PARSER_PROGRESSIVE(ctxt) \
     ((ctxt)->input->flags & XML_INPUT_PROGRESSIVE)
 
@@ -51,6 +69,11 @@
      (((ctxt)->input->entity->etype == XML_INTERNAL_PARAMETER_ENTITY) || \
       ((ctxt)->input->entity->etype == XML_EXTERNAL_PARAMETER_ENTITY)))
 
+/* Whether the tree builder drops content, see xmlCtxtSetPatternFilter */
+#define PARSER_FILTERED(ctxt) \
+    (((ctxt)->filterStreams != NULL) && ((ctxt)->filterDepth == 0) && \
+     ((ctxt)->node != NULL))
+
 #define PARSER_EXTERNAL(ctxt) \
     (((ctxt)->inSubset == 2) || \
      (((ctxt)->input->entity != NULL) && \
@@ -92,11 +115,33 @@ XML_HIDDEN void
 xmlCtxtErrIO(xmlParserCtxt *ctxt, int code, const char *uri);
 XML_HIDDEN int
 xmlCtxtIsCatastrophicError(xmlParserCtxt *ctxt);
+XML_HIDDEN char *
+xmlCtxtFormatDeferredError(xmlParserCtxt *ctxt, const xmlError *err);
 
 XML_HIDDEN int
 xmlParserGrow(xmlParserCtxt *ctxt);
+XML_HIDDEN int
+xmlParserCheckInterrupt(xmlParserCtxt *ctxt);
 XML_HIDDEN void
 xmlParserShrink(xmlParserCtxt *ctxt);
+XML_HIDDEN void
+xmlParserInputSetLazyLines(xmlParserInput *in);
+XML_HIDDEN void
+xmlParserInputSyncLines(xmlParserInput *in);
+
+XML_HIDDEN int
+xmlCtxtStartFilter(xmlParserCtxt *ctxt);
+XML_HIDDEN int
+xmlCtxtFilterPush(xmlParserCtxt *ctxt, const xmlChar *name,
+                  const xmlChar *ns);
+XML_HIDDEN void
+xmlCtxtFilterPop(xmlParserCtxt *ctxt);
+XML_HIDDEN void
+xmlCtxtFreeFilter(xmlParserCtxt *ctxt);
+XML_HIDDEN void
+xmlCtxtFreeEntityTemplates(xmlParserCtxt *ctxt);
+XML_HIDDEN void
+xmlCtxtFreeAttrPlans(xmlParserCtxt *ctxt);
 
 XML_HIDDEN void
 xmlDetectEncoding(xmlParserCtxt *ctxt);
@@ -163,6 +208,32 @@ XML_HIDDEN void
 xmlParserInputGetWindow(xmlParserInput *input, const xmlChar **startOut,
                         int *sizeInOut, int *offsetOut);
 
+XML_HIDDEN void
+xmlInitResourceCacheInternal(void);
+XML_HIDDEN void
+xmlCleanupResourceCacheInternal(void);
+XML_HIDDEN xmlParserInput *
+xmlLoadCachedResource(xmlParserCtxt *ctxt, const char *url,
+                      const char *publicId, xmlResourceType type);
+
+XML_HIDDEN void
+xmlInitDtdCacheInternal(void);
+XML_HIDDEN void
+xmlCleanupDtdCacheInternal(void);
+XML_HIDDEN xmlDtd *
+xmlDtdCacheLookup(xmlParserCtxt *ctxt, const xmlChar *publicId,
+                  const xmlChar *systemId);
+XML_HIDDEN void
+xmlDtdCacheRelease(xmlDoc *doc);
+
+XML_HIDDEN void
+xmlCtxtFreeSourceSpans(xmlParserCtxt *ctxt);
+
+XML_HIDDEN void
+xmlCtxtAddInputStats(xmlParserStats *stats, xmlParserInput *input);
+XML_HIDDEN void
+xmlCtxtResetStats(xmlParserCtxt *ctxt);
+
 static XML_INLINE void
 xmlSaturatedAdd(unsigned long *dst, unsigned long val) {
     if (val > ULONG_MAX - *dst)
@@ -179,4 +250,22 @@ xmlSaturatedAddSizeT(unsigned long *dst, size_t val) {
         *dst += val;
 }
 
+/*
+ * Bytes of the current input consumed so far, for tracing.
+ */
+static XML_INLINE long
+xmlCtxtTraceBytes(xmlParserCtxt *ctxt) {
+    unsigned long consumed;
+
+    if ((ctxt == NULL) || (ctxt->input == NULL))
+        return(-1);
+    consumed = ctxt->input->consumed;
+    if (ctxt->input->cur != NULL)
+        xmlSaturatedAddSizeT(&consumed,
+                             ctxt->input->cur - ctxt->input->base);
+    if (consumed > LONG_MAX)
+        return(LONG_MAX);
+    return(consumed);
+}
+
 #endif /* XML_PARSER_H_PRIVATE__ */
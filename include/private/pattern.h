@@ -0,0 +1,14 @@
+#ifndef XML_PATTERN_H_PRIVATE__
+#define XML_PATTERN_H_PRIVATE__
+
+#include <libxml/pattern.h>
+
+#ifdef LIBXML_PATTERN_ENABLED
+
+XML_HIDDEN int
+xmlPatternGetElementNames(xmlPattern *comp, const xmlChar **names,
+                          int max);
+
+#endif /* LIBXML_PATTERN_ENABLED */
+
+#endif /* XML_PATTERN_H_PRIVATE__ */
@@ -3,6 +3,8 @@
 
 #include <libxml/xmlautomata.h>
 
+#include "private/binary.h"
+
 #ifdef LIBXML_REGEXP_ENABLED
 
 /*
@@ -21,6 +23,53 @@ xmlAutomataSetFlags(xmlAutomata *am, int flags);
 XML_HIDDEN void
 xmlRegExecClearErrors(xmlRegExecCtxt* exec);
 
+typedef struct _xmlRegExecPool xmlRegExecPool;
+typedef xmlRegExecPool *xmlRegExecPoolPtr;
+
+XML_HIDDEN xmlRegExecPool *
+xmlRegExecPoolCreate(void);
+XML_HIDDEN void
+xmlRegExecPoolFree(xmlRegExecPool *pool);
+XML_HIDDEN xmlRegExecCtxt *
+xmlRegExecPoolGet(xmlRegExecPool *pool, xmlRegexp *comp,
+                  xmlRegExecCallbacks callback, void *data);
+XML_HIDDEN void
+xmlRegExecPoolPut(xmlRegExecPool *pool, xmlRegExecCtxt *exec);
+
+XML_HIDDEN int
+xmlRegexpBuildNameTable(xmlRegexp *regexp, xmlDict *dict);
+XML_HIDDEN int
+xmlRegexpHasNameTable(xmlRegexp *regexp);
+XML_HIDDEN int
+xmlRegexpNameStep(xmlRegexp *regexp, int state, const xmlChar *name);
+XML_HIDDEN int
+xmlRegexpIsFinalState(xmlRegexp *regexp, int state);
+XML_HIDDEN unsigned
+xmlRegExecHashName(const xmlChar *name, const xmlChar *ns);
+XML_HIDDEN int
+xmlRegExecPushName(xmlRegExecCtxt *exec, const xmlChar *name,
+                   const xmlChar *ns, unsigned hashValue, void *data);
+
+XML_HIDDEN void
+xmlInitRegexpCacheInternal(void);
+XML_HIDDEN void
+xmlCleanupRegexpCacheInternal(void);
+
+/*
+ * Callbacks translating the transition data of an automaton,
+ * typically pointers to schema components, to and from the
+ * binary format.
+ */
+typedef void (*xmlRegSaveDataFunc)(void *ctxt, xmlBuf *buf, void *data);
+typedef void *(*xmlRegLoadDataFunc)(void *ctxt, xmlBinReader *reader);
+
+XML_HIDDEN void
+xmlRegexpSave(xmlRegexp *regexp, xmlBuf *buf,
+              xmlRegSaveDataFunc saveData, void *ctxt);
+XML_HIDDEN xmlRegexp *
+xmlRegexpLoad(xmlBinReader *reader,
+              xmlRegLoadDataFunc loadData, void *ctxt);
+
 #endif /* LIBXML_REGEXP_ENABLED */
 
 #endif /* XML_REGEXP_H_PRIVATE__ */
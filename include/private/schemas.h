@@ -0,0 +1,37 @@
+#ifndef XML_SCHEMAS_H_PRIVATE__
+#define XML_SCHEMAS_H_PRIVATE__
+
+#include <libxml/schemasInternals.h>
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+
+#include <libxml/xmlschemas.h>
+
+#include "private/binary.h"
+
+XML_HIDDEN void
+xmlSchemaValSave(xmlSchemaVal *val, xmlBuf *buf);
+XML_HIDDEN xmlSchemaVal *
+xmlSchemaValLoad(xmlBinReader *reader);
+XML_HIDDEN int
+xmlSchemaValCanon(xmlSchemaVal *val, const xmlChar **canon);
+
+XML_HIDDEN int
+xmlSchemaValidateAttach(xmlSchemaValidCtxt *vctxt, xmlParserCtxt *pctxt);
+XML_HIDDEN void
+xmlSchemaValidateDetach(xmlSchemaValidCtxt *vctxt);
+XML_HIDDEN void
+xmlSchemaValidateStartTag(xmlSchemaValidCtxt *vctxt,
+                          const xmlChar *localname, const xmlChar *URI,
+                          int nb_namespaces, const xmlChar **namespaces,
+                          int nb_attributes, const xmlChar **attributes);
+XML_HIDDEN void
+xmlSchemaValidateEndTag(xmlSchemaValidCtxt *vctxt,
+                        const xmlChar *localname, const xmlChar *URI);
+XML_HIDDEN void
+xmlSchemaValidateText(xmlSchemaValidCtxt *vctxt, int cdata,
+                      const xmlChar *ch, int len);
+
+#endif /* LIBXML_SCHEMAS_ENABLED */
+
+#endif /* XML_SCHEMAS_H_PRIVATE__ */
@@ -0,0 +1,109 @@
+#ifndef XML_SIMD_H_PRIVATE__
+#define XML_SIMD_H_PRIVATE__
+
+#include <libxml/xmlstring.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define XML_SIMD_SSE2
+#endif
+
+#if (defined(__ARM_NEON) || defined(_M_ARM64)) && \
+    (defined(__aarch64__) || defined(_M_ARM64))
+  #define XML_SIMD_NEON
+#endif
+
+#if defined(XML_SIMD_SSE2) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+  #define XML_SIMD_AVX2
+#endif
+
+#if defined(XML_SIMD_SSE2) || defined(XML_SIMD_NEON)
+  #define XML_SIMD_ENABLED
+#endif
+
+#if defined(_MSC_VER) && defined(XML_SIMD_ENABLED)
+  #include <intrin.h>
+#endif
+
+/*
+ * A set of ASCII characters below 0x40 for nibble lookups. Entry `n`
+ * has bit `k` set if character 16 * k + n is in the set. Bit 7 is
+ * always set, so bytes >= 0x80 are always matched.
+ */
+typedef struct {
+    unsigned char lo[16];
+} xmlAsciiSet;
+
+#define XML_ASCII_SET_ENTRY(m0, m1, n) \
+    (unsigned char) (0x80 | \
+        (((m0) >> (n)) & 1) | ((((m0) >> (16 + (n))) & 1) << 1) | \
+        ((((m1) >> (n)) & 1) << 2) | ((((m1) >> (16 + (n))) & 1) << 3))
+
+/*
+ * Initializer for an xmlAsciiSet from two 32-bit masks of characters
+ * 0x00-0x1F and 0x20-0x3F.
+ */
+#define XML_ASCII_SET(m0, m1) { { \
+    XML_ASCII_SET_ENTRY(m0, m1, 0), XML_ASCII_SET_ENTRY(m0, m1, 1), \
+    XML_ASCII_SET_ENTRY(m0, m1, 2), XML_ASCII_SET_ENTRY(m0, m1, 3), \
+    XML_ASCII_SET_ENTRY(m0, m1, 4), XML_ASCII_SET_ENTRY(m0, m1, 5), \
+    XML_ASCII_SET_ENTRY(m0, m1, 6), XML_ASCII_SET_ENTRY(m0, m1, 7), \
+    XML_ASCII_SET_ENTRY(m0, m1, 8), XML_ASCII_SET_ENTRY(m0, m1, 9), \
+    XML_ASCII_SET_ENTRY(m0, m1, 10), XML_ASCII_SET_ENTRY(m0, m1, 11), \
+    XML_ASCII_SET_ENTRY(m0, m1, 12), XML_ASCII_SET_ENTRY(m0, m1, 13), \
+    XML_ASCII_SET_ENTRY(m0, m1, 14), XML_ASCII_SET_ENTRY(m0, m1, 15) } }
+
+XML_HIDDEN void
+xmlInitSimdInternal(void);
+
+XML_HIDDEN const xmlChar *
+xmlScanCharData(const xmlChar *cur, const xmlChar *end);
+XML_HIDDEN const xmlChar *
+xmlScanAttValue(const xmlChar *cur, const xmlChar *end, int quote,
+                int space);
+XML_HIDDEN const xmlChar *
+xmlScanEscape(const xmlChar *cur, const xmlChar *end, int nonAscii);
+XML_HIDDEN const xmlChar *
+xmlScanUtf8CharData(const xmlChar *cur, const xmlChar *end, size_t *nchars);
+XML_HIDDEN const xmlChar *
+xmlScanUri(const xmlChar *cur, const xmlChar *end);
+XML_HIDDEN const xmlChar *
+xmlScanAsciiSet(const xmlChar *cur, const xmlChar *end,
+                const xmlAsciiSet *set);
+XML_HIDDEN const xmlChar *
+xmlScanUtf8Chars(const xmlChar *cur, const xmlChar *end, size_t max,
+                 size_t *nchars);
+XML_HIDDEN size_t
+xmlUtf16ToAscii(unsigned char *out, const unsigned char *in, size_t n,
+                int bigEndian);
+XML_HIDDEN size_t
+xmlAsciiToUtf16(unsigned char *out, const unsigned char *in, size_t n,
+                int bigEndian);
+XML_HIDDEN size_t
+xmlCopyAscii(unsigned char *out, const unsigned char *in, size_t n);
+
+/*
+ * Index of the lowest set bit. `v` must be non-zero.
+ */
+static XML_INLINE unsigned
+xmlCountTrailingZeros(unsigned long long v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return(__builtin_ctzll(v));
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long idx;
+
+    _BitScanForward64(&idx, v);
+    return(idx);
+#else
+    unsigned n = 0;
+
+    while ((v & 1) == 0) {
+        v >>= 1;
+        n++;
+    }
+    return(n);
+#endif
+}
+
+#endif /* XML_SIMD_H_PRIVATE__ */
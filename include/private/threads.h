@@ -48,6 +48,31 @@ struct _xmlRMutex {
 #endif
 };
 
+/*
+ * Loads with acquire and stores with release semantics, for data
+ * which is published to readers not taking a lock. XML_HAVE_ATOMICS
+ * is defined if they are available. Without thread support, they
+ * are plain memory accesses.
+ */
+#if !defined(LIBXML_THREAD_ENABLED)
+  #define XML_HAVE_ATOMICS
+  #define xmlAtomicLoadInt(p) (*(p))
+  #define xmlAtomicStoreInt(p, v) (*(p) = (v))
+#elif defined(__GNUC__) || defined(__clang__)
+  #define XML_HAVE_ATOMICS
+  #define xmlAtomicLoadInt(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+  #define xmlAtomicStoreInt(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#elif defined(HAVE_WIN32_THREADS)
+  #define XML_HAVE_ATOMICS
+  #define xmlAtomicLoadInt(p) \
+    ((int) InterlockedCompareExchange((volatile LONG *) (p), 0, 0))
+  #define xmlAtomicStoreInt(p, v) \
+    ((void) InterlockedExchange((volatile LONG *) (p), (LONG) (v)))
+#else
+  #define xmlAtomicLoadInt(p) (*(p))
+  #define xmlAtomicStoreInt(p, v) (*(p) = (v))
+#endif
+
 XML_HIDDEN void
 xmlInitMutex(xmlMutex *mutex);
 XML_HIDDEN void
@@ -58,6 +83,9 @@ xmlInitRMutex(xmlRMutex *mutex);
 XML_HIDDEN void
 xmlCleanupRMutex(xmlRMutex *mutex);
 
+XML_HIDDEN unsigned long
+xmlMonotonicTimeMs(void);
+
 #ifdef LIBXML_SCHEMAS_ENABLED
 XML_HIDDEN void
 xmlInitSchemasTypesInternal(void);
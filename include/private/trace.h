@@ -0,0 +1,62 @@
+#ifndef XML_TRACE_H_PRIVATE__
+#define XML_TRACE_H_PRIVATE__
+
+#include <libxml/xmltrace.h>
+
+#ifdef HAVE_SYS_SDT_H
+  #include <sys/sdt.h>
+  #define XML_PROBE1(name, a) \
+      DTRACE_PROBE1(libxml2, name, a)
+  #define XML_PROBE2(name, a, b) \
+      DTRACE_PROBE2(libxml2, name, a, b)
+#else
+  #define XML_PROBE1(name, a)
+  #define XML_PROBE2(name, a, b)
+#endif
+
+XML_HIDDEN extern int
+xmlTraceActive;
+
+XML_HIDDEN double
+xmlTraceTime(void);
+XML_HIDDEN void
+xmlTraceEmit(xmlTraceEvent event, const char *name, long bytes,
+             double start);
+
+/*
+ * Start of a traced phase. Fires the `<probe>_start` probe, reports
+ * `event` to the handler unless it's 0 and records the start time in
+ * `start` if a handler is registered.
+ */
+#define XML_TRACE_BEGIN(probe, event, name, start) \
+    do { \
+        XML_PROBE1(probe##_start, name); \
+        (start) = 0.0; \
+        if (xmlTraceActive) { \
+            (start) = xmlTraceTime(); \
+            if ((event) != 0) \
+                xmlTraceEmit((xmlTraceEvent) (event), name, -1, 0.0); \
+        } \
+    } while (0)
+
+/*
+ * End of a phase started with XML_TRACE_BEGIN.
+ */
+#define XML_TRACE_END(probe, event, name, bytes, start) \
+    do { \
+        XML_PROBE2(probe##_done, name, bytes); \
+        if (xmlTraceActive) \
+            xmlTraceEmit(event, name, bytes, start); \
+    } while (0)
+
+/*
+ * Single event without duration.
+ */
+#define XML_TRACE_EVENT(probe, event, name, bytes) \
+    do { \
+        XML_PROBE2(probe, name, bytes); \
+        if (xmlTraceActive) \
+            xmlTraceEmit(event, name, bytes, 0.0); \
+    } while (0)
+
+#endif /* XML_TRACE_H_PRIVATE__ */
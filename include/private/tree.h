@@ -1,9 +1,104 @@
 #ifndef XML_TREE_H_PRIVATE__
 #define XML_TREE_H_PRIVATE__
 
+#include "dict.h"
+
+/*
+ * Internal document properties
+ *
+ * XML_DOC_SHARED_DTD: The document owns a DTD of the shared DTD
+ * cache.
+ *
+ * XML_DOC_LAZY_IDS: The document contains ID attributes which were
+ * only marked with XML_ATTRIBUTE_ID and not added to the ID table
+ * yet.
+ *
+ * XML_DOC_IMAGE: The document is a mapped image, see xmlDocMapImage.
+ */
+#define XML_DOC_SHARED_DTD  (1 << 16)
+#define XML_DOC_LAZY_IDS    (1 << 17)
+#define XML_DOC_IMAGE       (1 << 18)
+
 XML_HIDDEN extern int
 xmlRegisterCallbacks;
 
+XML_HIDDEN int
+xmlCollectLazyIds(xmlDoc *doc);
+
+/*
+ * Source text of an element, see xmlCtxtSetSourceSpans. `end` is
+ * set to 0 once the element or its content was modified.
+ */
+typedef struct {
+    const xmlNode *node;
+    size_t start;
+    size_t end;
+} xmlSourceSpan;
+
+typedef struct {
+    /* decoded text of the document entity */
+    xmlChar *text;
+    size_t size;
+    /* releases the text if it wasn't allocated with xmlMalloc */
+    xmlInputCloseCallback release;
+    void *releaseCtxt;
+    /* spans sorted by node address */
+    xmlSourceSpan *spans;
+    int nbSpans;
+} xmlDocSource;
+
+XML_HIDDEN void
+xmlCleanupTreeInternal(void);
+
+/*
+ * Namespace URIs get integer IDs from the dictionary of the document,
+ * see xmlDictNsId. Applications can replace `href`, so the IDs aren't
+ * stored on xmlNs. Users look them up once per namespace with a cache
+ * that is only valid while the tree isn't modified.
+ */
+typedef struct {
+    xmlDict *dict;
+    const xmlNs *ns;
+    int id;
+} xmlNsIdCache;
+
+static XML_INLINE void
+xmlNsIdCacheInit(xmlNsIdCache *cache, xmlDict *dict) {
+    cache->dict = dict;
+    cache->ns = NULL;
+    cache->id = 0;
+}
+
+static XML_INLINE int
+xmlNsIdCacheGet(xmlNsIdCache *cache, const xmlNs *ns) {
+    if (ns != cache->ns) {
+        cache->ns = ns;
+        cache->id = xmlDictNsId(cache->dict, ns->href, 0);
+    }
+    return(cache->id);
+}
+
+/*
+ * Compare two namespace URI IDs. Returns 1 if the URIs are equal,
+ * 0 if they differ and -1 if the strings must be compared.
+ */
+static XML_INLINE int
+xmlNsIdCompare(int id1, int id2) {
+    if (id1 == id2)
+        return((id1 != 0) ? 1 : -1);
+    if ((id1 != 0) && (id2 != 0) &&
+        (id1 / XML_DICT_NS_ID_BLOCK == id2 / XML_DICT_NS_ID_BLOCK))
+        return(0);
+    return(-1);
+}
+
+XML_HIDDEN void *
+xmlTreeAlloc(xmlDoc *doc, size_t size);
+XML_HIDDEN xmlChar *
+xmlTreeStrndup(xmlDoc *doc, const xmlChar *str, int len);
+XML_HIDDEN void
+xmlTreeFree(xmlDoc *doc, void *mem);
+
 XML_HIDDEN int
 xmlSearchNsSafe(xmlNode *node, const xmlChar *href, xmlNs **out);
 XML_HIDDEN int
@@ -17,10 +112,38 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
                   int extended);
 XML_HIDDEN xmlNode *
 xmlStaticCopyNodeList(xmlNode *node, xmlDoc *doc, xmlNode *parent);
+XML_HIDDEN size_t
+xmlDocSnapshotSize(xmlDocSnapshot *snap);
 XML_HIDDEN const xmlChar *
 xmlSplitQName4(const xmlChar *name, xmlChar **prefixPtr);
 
 XML_HIDDEN xmlChar *
 xmlNodeListGetStringInternal(const xmlNode *node, int escape, int flags);
 
+XML_HIDDEN int
+xmlDocIndexLookup(xmlNode *node, const xmlChar *name, const xmlChar *href,
+                  int self, xmlNode ***nodes, int *nb);
+XML_HIDDEN int
+xmlDocIndexLookupValue(xmlNode *node, const xmlChar *name,
+                       const xmlChar *href, const xmlChar *attrName,
+                       const xmlChar *attrHref, const xmlChar *value,
+                       int self, xmlNode ***nodes, int *nb);
+XML_HIDDEN int
+xmlDocIndexNodeOrder(xmlNode **nodes, int nb, int *keys);
+
+/*
+ * Minimum number of children for which xmlDocIndexChildren builds
+ * a child table.
+ */
+#define XML_CHILD_INDEX_MIN 64
+
+/* Children are only elements, text, CDATA, PIs and comments */
+#define XML_CHILD_INDEX_PLAIN   (1 << 0)
+/* All element children have the same name and namespace URI */
+#define XML_CHILD_INDEX_UNIFORM (1 << 1)
+
+XML_HIDDEN int
+xmlDocIndexChildren(xmlNode *parent, int elements, xmlNode ***nodes,
+                    int *nb, int *flags);
+
 #endif /* XML_TREE_H_PRIVATE__ */
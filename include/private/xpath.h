@@ -5,12 +5,18 @@
 
 XML_HIDDEN void
 xmlInitXPathInternal(void);
+XML_HIDDEN void
+xmlCleanupXPathInternal(void);
 
 #ifdef LIBXML_XPATH_ENABLED
 XML_HIDDEN void
 xmlXPathErrMemory(xmlXPathContext *ctxt);
 XML_HIDDEN void
 xmlXPathPErrMemory(xmlXPathParserContext *ctxt);
+XML_HIDDEN void
+xmlXPathFreeThreadCache(void *cache);
+XML_HIDDEN int
+xmlXPathCompExprUsesVariables(xmlXPathCompExpr *comp);
 #endif
 
 #endif /* XML_XPATH_H_PRIVATE__ */
@@ -66,6 +66,7 @@
 #ifdef LIBXML_CATALOG_ENABLED
 #include <libxml/catalog.h>
 #endif
+#include <libxml/pattern.h>
 
 #include "private/buf.h"
 #include "private/dict.h"
@@ -75,6 +76,10 @@
 #include "private/io.h"
 #include "private/memory.h"
 #include "private/parser.h"
+#include "private/schemas.h"
+#include "private/simd.h"
+#include "private/threads.h"
+#include "private/trace.h"
 #include "private/tree.h"
 
 #define NS_INDEX_EMPTY  INT_MAX
@@ -86,6 +91,10 @@
   #define STDIN_FILENO 0
 #endif
 
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #define XML_PARSER_PARALLEL
+#endif
+
 #ifndef SIZE_MAX
   #define SIZE_MAX ((size_t) -1)
 #endif
@@ -214,6 +223,12 @@ xmlLoadEntityContent(xmlParserCtxtPtr ctxt, xmlEntityPtr entity);
 static void
 xmlParsePERefInternal(xmlParserCtxt *ctxt, int markupDecl);
 
+static void
+xmlCtxtResetDocument(xmlParserCtxtPtr ctxt);
+
+static void
+xmlCtxtInvalidateSourceSpans(xmlParserCtxtPtr ctxt, int next);
+
 /************************************************************************
  *									*
  *		Some factorized error routines				*
@@ -438,6 +453,8 @@ xmlParserEntityCheck(xmlParserCtxtPtr ctxt, unsigned long extra)
     xmlParserInputPtr input = ctxt->input;
     xmlEntityPtr entity = input->entity;
 
+    ctxt->stats.entityExpansions++;
+
     if ((entity) && (entity->flags & XML_ENT_CHECKED))
         return(0);
 
@@ -652,6 +669,12 @@ xmlHasFeature(xmlFeature feature)
 #endif
         case XML_WITH_LZMA:
             return(0);
+        case XML_WITH_ZSTD:
+#ifdef LIBXML_ZSTD_ENABLED
+            return(1);
+#else
+            return(0);
+#endif
         case XML_WITH_ICU:
 #ifdef LIBXML_ICU_ENABLED
             return(1);
@@ -1026,6 +1049,8 @@ xmlAddDefAttrs(xmlParserCtxtPtr ctxt,
     xmlHashedString hvalue;
     const xmlChar *localname;
 
+    xmlCtxtFreeAttrPlans(ctxt);
+
     /*
      * Allows to detect attribute redefinitions
      */
@@ -1150,6 +1175,8 @@ xmlAddSpecialAttr(xmlParserCtxtPtr ctxt,
 		  const xmlChar *fullattr,
 		  int type)
 {
+    xmlCtxtFreeAttrPlans(ctxt);
+
     if (ctxt->attsSpecial == NULL) {
         ctxt->attsSpecial = xmlHashCreateDict(10, ctxt->dict);
 	if (ctxt->attsSpecial == NULL)
@@ -1195,6 +1222,7 @@ xmlCleanSpecialAttr(xmlParserCtxtPtr ctxt)
     if (ctxt->attsSpecial == NULL)
         return;
 
+    xmlCtxtFreeAttrPlans(ctxt);
     xmlHashScanFull(ctxt->attsSpecial, xmlCleanSpecialAttrCallback, ctxt);
 
     if (xmlHashSize(ctxt->attsSpecial) == 0) {
@@ -1203,6 +1231,218 @@ xmlCleanSpecialAttr(xmlParserCtxtPtr ctxt)
     }
 }
 
+/*
+ * Attribute plans
+ *
+ * After the DTD was parsed, the default attributes and the special
+ * attribute types are compiled into one plan per element so that
+ * start tags only need a single hash lookup.
+ */
+
+typedef struct {
+    const xmlChar *prefix;
+    const xmlChar *name;
+    int type;
+} xmlAttrPlanSpecial;
+
+typedef struct {
+    xmlDefAttrsPtr defaults;	/* owned by attsDefault */
+    int nsDefaults;		/* number of namespace declarations */
+    int nbSpecial;
+    int maxSpecial;
+    xmlAttrPlanSpecial *special;
+} xmlAttrPlan;
+
+static void
+xmlFreeAttrPlan(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlAttrPlan *plan = payload;
+
+    xmlFree(plan->special);
+    xmlFree(plan);
+}
+
+/**
+ * Free the compiled attribute plans. Must be called whenever the
+ * default or special attribute tables change.
+ *
+ * @param ctxt  an XML parser context
+ */
+void
+xmlCtxtFreeAttrPlans(xmlParserCtxtPtr ctxt) {
+    xmlHashFree(ctxt->attsPlans, xmlFreeAttrPlan);
+    ctxt->attsPlans = NULL;
+}
+
+/*
+ * Split a name from the DTD the same way xmlParseQNameHashed splits
+ * names in the document: only a pair of NCNames has a prefix.
+ */
+static const xmlChar *
+xmlAttrPlanSplit(xmlParserCtxtPtr ctxt, const xmlChar *qname,
+                 const xmlChar **prefix) {
+    const xmlChar *local;
+    int len;
+
+    *prefix = NULL;
+    local = xmlSplitQName3(qname, &len);
+    if ((local != NULL) && (xmlValidateNCName(local, 0) == 0)) {
+        const xmlChar *pref = xmlDictLookup(ctxt->dict, qname, len);
+
+        if ((pref != NULL) && (xmlValidateNCName(pref, 0) == 0)) {
+            *prefix = pref;
+            return(xmlDictLookup(ctxt->dict, local, -1));
+        }
+    }
+
+    return(xmlDictLookup(ctxt->dict, qname, -1));
+}
+
+static xmlAttrPlan *
+xmlAttrPlanGet(xmlParserCtxtPtr ctxt, const xmlChar *localname,
+               const xmlChar *prefix) {
+    xmlAttrPlan *plan;
+
+    plan = xmlHashLookup2(ctxt->attsPlans, localname, prefix);
+    if (plan != NULL)
+        return(plan);
+
+    plan = xmlMalloc(sizeof(*plan));
+    if (plan == NULL)
+        return(NULL);
+    memset(plan, 0, sizeof(*plan));
+    if (xmlHashAdd2(ctxt->attsPlans, localname, prefix, plan) < 0) {
+        xmlFree(plan);
+        return(NULL);
+    }
+
+    return(plan);
+}
+
+static void
+xmlAttrPlanAddDefaults(void *payload, void *data,
+                       const xmlChar *localname, const xmlChar *prefix,
+                       const xmlChar *unused ATTRIBUTE_UNUSED) {
+    xmlParserCtxtPtr ctxt = data;
+    xmlDefAttrsPtr defaults = payload;
+    xmlAttrPlan *plan;
+    int i;
+
+    plan = xmlAttrPlanGet(ctxt, localname, prefix);
+    if (plan == NULL) {
+        xmlErrMemory(ctxt);
+        return;
+    }
+
+    plan->defaults = defaults;
+    for (i = 0; i < defaults->nbAttrs; i++) {
+        xmlDefAttr *attr = &defaults->attrs[i];
+
+        if (((attr->name.name == ctxt->str_xmlns) &&
+             (attr->prefix.name == NULL)) ||
+            (attr->prefix.name == ctxt->str_xmlns))
+            plan->nsDefaults++;
+    }
+}
+
+static void
+xmlAttrPlanAddSpecial(void *payload, void *data,
+                      const xmlChar *fullname, const xmlChar *fullattr,
+                      const xmlChar *unused ATTRIBUTE_UNUSED) {
+    xmlParserCtxtPtr ctxt = data;
+    xmlAttrPlan *plan;
+    xmlAttrPlanSpecial *special;
+    const xmlChar *localname, *prefix;
+    const xmlChar *name, *aprefix;
+
+    localname = xmlAttrPlanSplit(ctxt, fullname, &prefix);
+    name = xmlAttrPlanSplit(ctxt, fullattr, &aprefix);
+    if ((localname == NULL) || (name == NULL))
+        goto mem_error;
+
+    plan = xmlAttrPlanGet(ctxt, localname, prefix);
+    if (plan == NULL)
+        goto mem_error;
+
+    if (plan->nbSpecial >= plan->maxSpecial) {
+        xmlAttrPlanSpecial *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(plan->maxSpecial, sizeof(tmp[0]),
+                                  4, XML_MAX_ATTRS);
+        if (newSize < 0)
+            goto mem_error;
+        tmp = xmlRealloc(plan->special, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto mem_error;
+        plan->special = tmp;
+        plan->maxSpecial = newSize;
+    }
+
+    special = &plan->special[plan->nbSpecial++];
+    special->prefix = aprefix;
+    special->name = name;
+    special->type = XML_PTR_TO_INT(payload);
+    return;
+
+mem_error:
+    xmlErrMemory(ctxt);
+}
+
+/**
+ * Look up the attribute plan of an element, compiling the plans of
+ * all elements on first use.
+ *
+ * @param ctxt  an XML parser context
+ * @param localname  the element name
+ * @param prefix  the element prefix
+ * @returns the plan or NULL if the element has neither default nor
+ * special attributes
+ */
+static const xmlAttrPlan *
+xmlCtxtLookupAttrPlan(xmlParserCtxtPtr ctxt, const xmlChar *localname,
+                      const xmlChar *prefix) {
+    if ((ctxt->attsDefault == NULL) && (ctxt->attsSpecial == NULL))
+        return(NULL);
+
+    if (ctxt->attsPlans == NULL) {
+        ctxt->attsPlans = xmlHashCreateDict(0, ctxt->dict);
+        if (ctxt->attsPlans == NULL) {
+            xmlErrMemory(ctxt);
+            return(NULL);
+        }
+        if (ctxt->attsDefault != NULL)
+            xmlHashScanFull(ctxt->attsDefault, xmlAttrPlanAddDefaults, ctxt);
+        if (ctxt->attsSpecial != NULL)
+            xmlHashScanFull(ctxt->attsSpecial, xmlAttrPlanAddSpecial, ctxt);
+    }
+
+    return(xmlHashLookup2(ctxt->attsPlans, localname, prefix));
+}
+
+/**
+ * @param plan  the attribute plan of the element or NULL
+ * @param prefix  the attribute prefix
+ * @param name  the attribute name
+ * @returns the value from attsSpecial or 0
+ */
+static int
+xmlAttrPlanSpecialType(const xmlAttrPlan *plan, const xmlChar *prefix,
+                       const xmlChar *name) {
+    int i;
+
+    if (plan == NULL)
+        return(0);
+
+    for (i = 0; i < plan->nbSpecial; i++) {
+        const xmlAttrPlanSpecial *special = &plan->special[i];
+
+        if ((special->name == name) && (special->prefix == prefix))
+            return(special->type);
+    }
+
+    return(0);
+}
+
 /**
  * Checks that the value conforms to the LanguageID production:
  *
@@ -1934,6 +2174,11 @@ xmlCtxtPushInput(xmlParserCtxt *ctxt, xmlParserInput *value)
     ctxt->inputTab[ctxt->inputNr] = value;
     ctxt->input = value;
 
+    if ((ctxt->statsTiming) && (value->buf != NULL))
+        value->buf->convTiming = 1;
+    if ((ctxt->lazyLines) && (!ctxt->html))
+        xmlParserInputSetLazyLines(value);
+
     if (ctxt->inputNr == 0) {
         xmlFree(ctxt->directory);
         ctxt->directory = directory;
@@ -1971,6 +2216,7 @@ xmlCtxtPopInput(xmlParserCtxt *ctxt)
         ctxt->input = NULL;
     ret = ctxt->inputTab[ctxt->inputNr];
     ctxt->inputTab[ctxt->inputNr] = NULL;
+    xmlCtxtAddInputStats(&ctxt->stats, ret);
     return (ret);
 }
 
@@ -2095,6 +2341,8 @@ nameNsPush(xmlParserCtxtPtr ctxt, const xmlChar * value,
     tag->URI = URI;
     tag->line = line;
     tag->nsNr = nsNr;
+    if (ctxt->nameNr >= ctxt->stats.maxDepth)
+        ctxt->stats.maxDepth = ctxt->nameNr + 1;
     return (ctxt->nameNr++);
 mem_error:
     xmlErrMemory(ctxt);
@@ -2317,14 +2565,18 @@ xmlCurrentCharRecover(xmlParserCtxtPtr ctxt, int *len) {
 int
 xmlSkipBlankChars(xmlParserCtxt *ctxt) {
     const xmlChar *cur;
+    int lazy = ctxt->input->flags & XML_INPUT_LAZY_LINES;
     int res = 0;
 
     cur = ctxt->input->cur;
     while (IS_BLANK_CH(*cur)) {
-        if (*cur == '\n') {
-            ctxt->input->line++; ctxt->input->col = 1;
-        } else {
-            ctxt->input->col++;
+        /* With lazy line numbers, they're computed on demand */
+        if (!lazy) {
+            if (*cur == '\n') {
+                ctxt->input->line++; ctxt->input->col = 1;
+            } else {
+                ctxt->input->col++;
+            }
         }
         cur++;
         if (res < INT_MAX)
@@ -2943,79 +3195,45 @@ xmlSplitQName(xmlParserCtxt *ctxt, const xmlChar *name, xmlChar **prefixOut) {
  * new XML_PARSE_OLD10 option is given to the parser.
  */
 
+#include "codegen/names.inc"
+
+/*
+ * Look up a BMP code point in the name character bitmaps generated
+ * from codegen/ranges.def.
+ */
+#define XML_NAME_BIT(c, cls) \
+    ((xmlNameBitsTab[xmlNamePageTab[(c) >> 8]][cls][((c) & 0xFF) >> 3] >> \
+      ((c) & 7)) & 1)
+
 static int
 xmlIsNameStartCharNew(int c) {
     /*
      * Use the new checks of production [4] [4a] amd [5] of the
      * Update 5 of XML-1.0
      */
-    if ((c != ' ') && (c != '>') && (c != '/') && /* accelerators */
-        (((c >= 'a') && (c <= 'z')) ||
-         ((c >= 'A') && (c <= 'Z')) ||
-         (c == '_') || (c == ':') ||
-         ((c >= 0xC0) && (c <= 0xD6)) ||
-         ((c >= 0xD8) && (c <= 0xF6)) ||
-         ((c >= 0xF8) && (c <= 0x2FF)) ||
-         ((c >= 0x370) && (c <= 0x37D)) ||
-         ((c >= 0x37F) && (c <= 0x1FFF)) ||
-         ((c >= 0x200C) && (c <= 0x200D)) ||
-         ((c >= 0x2070) && (c <= 0x218F)) ||
-         ((c >= 0x2C00) && (c <= 0x2FEF)) ||
-         ((c >= 0x3001) && (c <= 0xD7FF)) ||
-         ((c >= 0xF900) && (c <= 0xFDCF)) ||
-         ((c >= 0xFDF0) && (c <= 0xFFFD)) ||
-         ((c >= 0x10000) && (c <= 0xEFFFF))))
-        return(1);
-    return(0);
+    if ((c >= 0) && (c < 0x10000))
+        return(XML_NAME_BIT(c, XML_NAME_START));
+    return((c >= 0x10000) && (c <= 0xEFFFF));
 }
 
 static int
 xmlIsNameCharNew(int c) {
-    /*
-     * Use the new checks of production [4] [4a] amd [5] of the
-     * Update 5 of XML-1.0
-     */
-    if ((c != ' ') && (c != '>') && (c != '/') && /* accelerators */
-        (((c >= 'a') && (c <= 'z')) ||
-         ((c >= 'A') && (c <= 'Z')) ||
-         ((c >= '0') && (c <= '9')) || /* !start */
-         (c == '_') || (c == ':') ||
-         (c == '-') || (c == '.') || (c == 0xB7) || /* !start */
-         ((c >= 0xC0) && (c <= 0xD6)) ||
-         ((c >= 0xD8) && (c <= 0xF6)) ||
-         ((c >= 0xF8) && (c <= 0x2FF)) ||
-         ((c >= 0x300) && (c <= 0x36F)) || /* !start */
-         ((c >= 0x370) && (c <= 0x37D)) ||
-         ((c >= 0x37F) && (c <= 0x1FFF)) ||
-         ((c >= 0x200C) && (c <= 0x200D)) ||
-         ((c >= 0x203F) && (c <= 0x2040)) || /* !start */
-         ((c >= 0x2070) && (c <= 0x218F)) ||
-         ((c >= 0x2C00) && (c <= 0x2FEF)) ||
-         ((c >= 0x3001) && (c <= 0xD7FF)) ||
-         ((c >= 0xF900) && (c <= 0xFDCF)) ||
-         ((c >= 0xFDF0) && (c <= 0xFFFD)) ||
-         ((c >= 0x10000) && (c <= 0xEFFFF))))
-         return(1);
-    return(0);
+    if ((c >= 0) && (c < 0x10000))
+        return(XML_NAME_BIT(c, XML_NAME_CHAR));
+    return((c >= 0x10000) && (c <= 0xEFFFF));
 }
 
 static int
 xmlIsNameStartCharOld(int c) {
-    if ((c != ' ') && (c != '>') && (c != '/') && /* accelerators */
-        ((IS_LETTER(c) || (c == '_') || (c == ':'))))
-        return(1);
+    if ((c >= 0) && (c < 0x10000))
+        return(XML_NAME_BIT(c, XML_NAME_START_OLD10));
     return(0);
 }
 
 static int
 xmlIsNameCharOld(int c) {
-    if ((c != ' ') && (c != '>') && (c != '/') && /* accelerators */
-        ((IS_LETTER(c)) || (IS_DIGIT(c)) ||
-         (c == '.') || (c == '-') ||
-         (c == '_') || (c == ':') ||
-         (IS_COMBINING(c)) ||
-         (IS_EXTENDER(c))))
-        return(1);
+    if ((c >= 0) && (c < 0x10000))
+        return(XML_NAME_BIT(c, XML_NAME_CHAR_OLD10));
     return(0);
 }
 
@@ -3150,6 +3368,7 @@ const xmlChar *
 xmlParseName(xmlParserCtxt *ctxt) {
     const xmlChar *in;
     const xmlChar *ret;
+    xmlHashState st;
     size_t count = 0;
     size_t maxLength = (ctxt->options & XML_PARSE_HUGE) ?
                        XML_MAX_TEXT_LENGTH :
@@ -3158,26 +3377,31 @@ xmlParseName(xmlParserCtxt *ctxt) {
     GROW;
 
     /*
-     * Accelerator for simple ASCII names
+     * Accelerator for simple ASCII names, hashed while scanning
      */
     in = ctxt->input->cur;
     if (((*in >= 0x61) && (*in <= 0x7A)) ||
 	((*in >= 0x41) && (*in <= 0x5A)) ||
 	(*in == '_') || (*in == ':')) {
+        xmlDictHashStart(ctxt->dict, &st);
+        xmlHashUpdateByte(&st, *in);
 	in++;
 	while (((*in >= 0x61) && (*in <= 0x7A)) ||
 	       ((*in >= 0x41) && (*in <= 0x5A)) ||
 	       ((*in >= 0x30) && (*in <= 0x39)) ||
 	       (*in == '_') || (*in == '-') ||
-	       (*in == ':') || (*in == '.'))
+	       (*in == ':') || (*in == '.')) {
+            xmlHashUpdateByte(&st, *in);
 	    in++;
+        }
 	if ((*in > 0) && (*in < 0x80)) {
 	    count = in - ctxt->input->cur;
             if (count > maxLength) {
                 xmlFatalErr(ctxt, XML_ERR_NAME_TOO_LONG, "Name");
                 return(NULL);
             }
-	    ret = xmlDictLookup(ctxt->dict, ctxt->input->cur, count);
+	    ret = xmlDictLookupHashedName(ctxt->dict, ctxt->input->cur,
+                                          count, xmlHashFinish(&st)).name;
 	    ctxt->input->cur = in;
 	    ctxt->input->col += count;
 	    if (ret == NULL)
@@ -3246,6 +3470,7 @@ static xmlHashedString
 xmlParseNCName(xmlParserCtxtPtr ctxt) {
     const xmlChar *in, *e;
     xmlHashedString ret;
+    xmlHashState st;
     size_t count = 0;
     size_t maxLength = (ctxt->options & XML_PARSE_HUGE) ?
                        XML_MAX_TEXT_LENGTH :
@@ -3254,20 +3479,25 @@ xmlParseNCName(xmlParserCtxtPtr ctxt) {
     ret.name = NULL;
 
     /*
-     * Accelerator for simple ASCII names
+     * Accelerator for simple ASCII names. The dictionary hash is
+     * computed while scanning, so the name is only read once.
      */
     in = ctxt->input->cur;
     e = ctxt->input->end;
     if ((((*in >= 0x61) && (*in <= 0x7A)) ||
 	 ((*in >= 0x41) && (*in <= 0x5A)) ||
 	 (*in == '_')) && (in < e)) {
+        xmlDictHashStart(ctxt->dict, &st);
+        xmlHashUpdateByte(&st, *in);
 	in++;
 	while ((((*in >= 0x61) && (*in <= 0x7A)) ||
 	        ((*in >= 0x41) && (*in <= 0x5A)) ||
 	        ((*in >= 0x30) && (*in <= 0x39)) ||
 	        (*in == '_') || (*in == '-') ||
-	        (*in == '.')) && (in < e))
+	        (*in == '.')) && (in < e)) {
+            xmlHashUpdateByte(&st, *in);
 	    in++;
+        }
 	if (in >= e)
 	    goto complex;
 	if ((*in > 0) && (*in < 0x80)) {
@@ -3276,7 +3506,8 @@ xmlParseNCName(xmlParserCtxtPtr ctxt) {
                 xmlFatalErr(ctxt, XML_ERR_NAME_TOO_LONG, "NCName");
                 return(ret);
             }
-	    ret = xmlDictLookupHashed(ctxt->dict, ctxt->input->cur, count);
+	    ret = xmlDictLookupHashedName(ctxt->dict, ctxt->input->cur,
+                                          count, xmlHashFinish(&st));
 	    ctxt->input->cur = in;
 	    ctxt->input->col += count;
 	    if (ret.name == NULL) {
@@ -3764,9 +3995,13 @@ xmlCheckEntityInAttValue(xmlParserCtxtPtr ctxt, xmlEntityPtr pent, int depth) {
             if ((ent != NULL) &&
                 (ent->etype != XML_INTERNAL_PREDEFINED_ENTITY)) {
                 if ((ent->flags & flags) != flags) {
-                    pent->flags |= XML_ENT_EXPANDING;
-                    xmlCheckEntityInAttValue(ctxt, ent, depth);
-                    pent->flags &= ~XML_ENT_EXPANDING;
+                    if (pent->flags & XML_ENT_SHARED) {
+                        xmlCheckEntityInAttValue(ctxt, ent, depth);
+                    } else {
+                        pent->flags |= XML_ENT_EXPANDING;
+                        xmlCheckEntityInAttValue(ctxt, ent, depth);
+                        pent->flags &= ~XML_ENT_EXPANDING;
+                    }
                 }
 
                 xmlSaturatedAdd(&expandedSize, ent->expandedSize);
@@ -3776,6 +4011,12 @@ xmlCheckEntityInAttValue(xmlParserCtxtPtr ctxt, xmlEntityPtr pent, int depth) {
     }
 
 done:
+    /*
+     * Shared entities are checked again on every use.
+     */
+    if (pent->flags & XML_ENT_SHARED)
+        return;
+
     if (ctxt->inSubset == 0)
         pent->expandedSize = expandedSize;
 
@@ -3933,11 +4174,11 @@ xmlExpandEntityInAttValue(xmlParserCtxtPtr ctxt, xmlSBuf *buf,
 
                 *inSpace = 0;
 	    } else if ((ent != NULL) && (ent->content != NULL)) {
-                if (pent != NULL)
+                if ((pent != NULL) && ((pent->flags & XML_ENT_SHARED) == 0))
                     pent->flags |= XML_ENT_EXPANDING;
 		normChange |= xmlExpandEntityInAttValue(ctxt, buf,
                         ent->content, ent, normalize, inSpace, depth, check);
-                if (pent != NULL)
+                if ((pent != NULL) && ((pent->flags & XML_ENT_SHARED) == 0))
                     pent->flags &= ~XML_ENT_EXPANDING;
 	    }
         }
@@ -4054,17 +4295,38 @@ xmlParseAttValueInternal(xmlParserCtxtPtr ctxt, int *attlen, int *outFlags,
         if (PARSER_STOPPED(ctxt))
             goto error;
 
+        /*
+         * TODO: Check growth threshold
+         */
+        if (ctxt->input->end - CUR_PTR < 10)
+            GROW;
+
         if (CUR_PTR >= ctxt->input->end) {
             xmlFatalErrMsg(ctxt, XML_ERR_ATTRIBUTE_NOT_FINISHED,
                            "AttValue: ' expected\n");
             goto error;
         }
 
+#ifdef XML_SIMD_ENABLED
         /*
-         * TODO: Check growth threshold
+         * Skip runs of plain characters. Don't skip spaces when
+         * normalizing.
          */
-        if (ctxt->input->end - CUR_PTR < 10)
-            GROW;
+        {
+            const xmlChar *skip = xmlScanAttValue(CUR_PTR,
+                    ctxt->input->end, quote, !normalize);
+
+            if (skip > CUR_PTR) {
+                int n = skip - CUR_PTR;
+
+                ctxt->input->col += n;
+                CUR_PTR += n;
+                chunkSize += n;
+                inSpace = (skip[-1] == 0x20);
+                continue;
+            }
+        }
+#endif
 
         c = CUR;
 
@@ -4179,8 +4441,14 @@ xmlParseAttValueInternal(xmlParserCtxtPtr ctxt, int *attlen, int *outFlags,
             }
 
             ent = xmlLookupGeneralEntity(ctxt, name, /* isAttr */ 1);
-            if (ent == NULL)
+            if (ent == NULL) {
+                xmlCtxtInvalidateSourceSpans(ctxt, 1);
                 continue;
+            }
+
+            if ((ctxt->replaceEntities) &&
+                (ent->etype != XML_INTERNAL_PREDEFINED_ENTITY))
+                xmlCtxtInvalidateSourceSpans(ctxt, 1);
 
             if (ent->etype == XML_INTERNAL_PREDEFINED_ENTITY) {
                 if ((ent->content[0] == '&') && (!replaceEntities))
@@ -4198,7 +4466,8 @@ xmlParseAttValueInternal(xmlParserCtxtPtr ctxt, int *attlen, int *outFlags,
                     xmlCheckEntityInAttValue(ctxt, ent, ctxt->inputNr);
 
                 if (xmlParserEntityCheck(ctxt, ent->expandedSize)) {
-                    ent->content[0] = 0;
+                    if ((ent->flags & XML_ENT_SHARED) == 0)
+                        ent->content[0] = 0;
                     goto error;
                 }
 
@@ -4444,6 +4713,52 @@ xmlParsePubidLiteral(xmlParserCtxt *ctxt) {
 
 static void xmlParseCharDataComplex(xmlParserCtxtPtr ctxt, int partial);
 
+/**
+ * Check for a non-ASCII character in character data without decoding
+ * it with xmlCurrentChar.
+ *
+ * @param cur  pointer to the input
+ * @param end  end of the input
+ * @returns the length of the valid UTF-8 sequence at `cur` if it
+ * encodes a non-ASCII XML character, 0 otherwise.
+ */
+static XML_INLINE int
+xmlUtf8CharLen(const xmlChar *cur, const xmlChar *end) {
+    size_t avail = end - cur;
+    unsigned c = cur[0];
+    unsigned val;
+
+    if (c < 0xC2)
+        return(0);
+
+    if (c < 0xE0) {
+        if ((avail < 2) || ((cur[1] & 0xC0) != 0x80))
+            return(0);
+        return(2);
+    }
+
+    if (c < 0xF0) {
+        if ((avail < 3) ||
+            ((cur[1] & 0xC0) != 0x80) || ((cur[2] & 0xC0) != 0x80))
+            return(0);
+        val = (c & 0x0F) << 12 | (cur[1] & 0x3F) << 6 | (cur[2] & 0x3F);
+        if ((val < 0x800) || ((val >= 0xD800) && (val < 0xE000)) ||
+            (val >= 0xFFFE))
+            return(0);
+        return(3);
+    }
+
+    if ((avail < 4) ||
+        ((cur[1] & 0xC0) != 0x80) || ((cur[2] & 0xC0) != 0x80) ||
+        ((cur[3] & 0xC0) != 0x80))
+        return(0);
+    val = (c & 0x07) << 18 | (cur[1] & 0x3F) << 12 |
+          (cur[2] & 0x3F) << 6 | (cur[3] & 0x3F);
+    if ((c >= 0xF8) || (val < 0x10000) || (val > 0x10FFFF))
+        return(0);
+    return(4);
+}
+
 /*
  * used for the test in the inner loop of the char data testing
  */
@@ -4482,6 +4797,24 @@ static const unsigned char test_char_data[256] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
+/*
+ * Pass text to a schema validation context attached with
+ * xmlSchemaValidateAttach.
+ */
+static void
+xmlCtxtValidateText(xmlParserCtxtPtr ctxt, int cdata, const xmlChar *buf,
+                    int size) {
+#ifdef LIBXML_SCHEMAS_ENABLED
+    if ((ctxt->schemaValid != NULL) && (!ctxt->disableSAX))
+        xmlSchemaValidateText(ctxt->schemaValid, cdata, buf, size);
+#else
+    (void) ctxt;
+    (void) cdata;
+    (void) buf;
+    (void) size;
+#endif
+}
+
 static void
 xmlCharacters(xmlParserCtxtPtr ctxt, const xmlChar *buf, int size,
               int isBlank) {
@@ -4503,9 +4836,12 @@ xmlCharacters(xmlParserCtxtPtr ctxt, const xmlChar *buf, int size,
         if ((ctxt->sax->ignorableWhitespace != NULL) &&
             (ctxt->keepBlanks))
             ctxt->sax->ignorableWhitespace(ctxt->userData, buf, size);
+        if (ctxt->keepBlanks)
+            xmlCtxtValidateText(ctxt, 0, buf, size);
     } else {
         if (ctxt->sax->characters != NULL)
             ctxt->sax->characters(ctxt->userData, buf, size);
+        xmlCtxtValidateText(ctxt, 0, buf, size);
 
         /*
          * The old code used to update this value for "complex" data
@@ -4536,6 +4872,7 @@ xmlParseCharDataInternal(xmlParserCtxtPtr ctxt, int partial) {
     int col = ctxt->input->col;
     int ccol;
     int terminate = 0;
+    int lazy = ctxt->input->flags & XML_INPUT_LAZY_LINES;
 
     GROW;
     /*
@@ -4569,11 +4906,50 @@ get_more_space:
 
 get_more:
         ccol = ctxt->input->col;
+#ifdef XML_SIMD_ENABLED
+        {
+            const xmlChar *skip = xmlScanCharData(in, ctxt->input->end);
+
+            ccol += skip - in;
+            in = skip;
+        }
+#endif
         while (test_char_data[*in]) {
             in++;
             ccol++;
         }
         ctxt->input->col = ccol;
+        if ((*in == 0xA) && (lazy)) {
+            /* Line numbers are computed on demand */
+            in++;
+            goto get_more;
+        }
+        if (*in >= 0x80) {
+            /*
+             * Skip valid UTF-8 without the slow path. Invalid
+             * sequences are left to xmlParseCharDataComplex which
+             * reports errors.
+             */
+            const xmlChar *end = ctxt->input->end;
+            int len;
+
+#ifdef XML_SIMD_ENABLED
+            size_t nchars;
+            const xmlChar *skip = xmlScanUtf8CharData(in, end, &nchars);
+
+            if (skip > in) {
+                ctxt->input->col += nchars;
+                in = skip;
+                goto get_more;
+            }
+#endif
+            len = xmlUtf8CharLen(in, end);
+            if (len > 0) {
+                ctxt->input->col++;
+                in += len;
+                goto get_more;
+            }
+        }
         if (*in == 0xA) {
             do {
                 ctxt->input->line++; ctxt->input->col = 1;
@@ -4640,7 +5016,8 @@ invoke_callback:
         GROW;
         in = ctxt->input->cur;
     } while (((*in >= 0x20) && (*in <= 0x7F)) ||
-             (*in == 0x09) || (*in == 0x0a));
+             (*in == 0x09) || (*in == 0x0a) ||
+             (xmlUtf8CharLen(in, ctxt->input->end) > 0));
     ctxt->input->line = line;
     ctxt->input->col = col;
     xmlParseCharDataComplex(ctxt, partial);
@@ -7026,8 +7403,12 @@ xmlParseTextDecl(xmlParserCtxt *ctxt) {
 void
 xmlParseExternalSubset(xmlParserCtxt *ctxt, const xmlChar *publicId,
                        const xmlChar *systemId) {
+    const char *url = (const char *) systemId;
+    double start;
     int oldInputNr;
 
+    XML_TRACE_BEGIN(dtd_load, 0, url, start);
+
     xmlCtxtInitializeLate(ctxt);
 
     xmlDetectEncoding(ctxt);
@@ -7039,7 +7420,7 @@ xmlParseExternalSubset(xmlParserCtxt *ctxt, const xmlChar *publicId,
         ctxt->myDoc = xmlNewDoc(BAD_CAST "1.0");
 	if (ctxt->myDoc == NULL) {
 	    xmlErrMemory(ctxt);
-	    return;
+	    goto done;
 	}
 	ctxt->myDoc->properties = XML_DOC_INTERNAL;
     }
@@ -7077,59 +7458,365 @@ xmlParseExternalSubset(xmlParserCtxt *ctxt, const xmlChar *publicId,
         SHRINK;
         GROW;
     }
+
+done:
+    XML_TRACE_END(dtd_load, XML_TRACE_DTD_LOAD, url,
+                  xmlCtxtTraceBytes(ctxt), start);
 }
 
-/**
- * Parse and handle entity references in content, depending on the SAX
- * interface, this may end-up in a call to character() if this is a
- * CharRef, a predefined entity, if there is no reference() callback.
- * or if the parser was asked to switch to that mode.
- *
- * @deprecated Internal function, don't use.
- *
- * Always consumes '&'.
- *
- *     [67] Reference ::= EntityRef | CharRef
- * @param ctxt  an XML parser context
+/*
+ * Templates of entity content
+ *
+ * When entities are substituted, the content of an entity is copied
+ * for each reference. Entities referenced many times are copied from
+ * a template, a flat array of the nodes in document order. Names and
+ * text owned by the dictionary are shared with the copies, so that
+ * instantiating the template only allocates nodes and the remaining
+ * text. Content with namespaces or unusual nodes is copied with
+ * xmlDocCopyNode.
  */
-void
-xmlParseReference(xmlParserCtxt *ctxt) {
-    xmlEntityPtr ent = NULL;
+
+typedef struct {
+    xmlElementType type;
+    int depth;                  /* nesting depth in the entity */
     const xmlChar *name;
-    xmlChar *val;
+    const xmlChar *content;
+    int len;                    /* length of content */
+    int shared;                 /* content is owned by the dictionary */
+    unsigned short line;
+    xmlAttrPtr properties;      /* attributes to copy */
+} xmlEntityTemplateNode;
 
-    if (RAW != '&')
-        return;
+typedef struct {
+    xmlEntityPtr ent;
+    xmlNodePtr children;        /* content the template was built from */
+    int nbNodes;
+    int maxDepth;
+    xmlEntityTemplateNode *nodes; /* NULL if the content is copied */
+} xmlEntityTemplate;
 
-    /*
-     * Simple case of a CharRef
-     */
-    if (NXT(1) == '#') {
-	int i = 0;
-	xmlChar out[16];
-	int value = xmlParseCharRef(ctxt);
+static void
+xmlFreeEntityTemplate(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlEntityTemplate *tmpl = payload;
 
-	if (value == 0)
-	    return;
+    xmlFree(tmpl->nodes);
+    xmlFree(tmpl);
+}
 
-        /*
-         * Just encode the value in UTF-8
-         */
-        COPY_BUF(out, i, value);
-        out[i] = 0;
-        if ((ctxt->sax != NULL) && (ctxt->sax->characters != NULL) &&
-            (!ctxt->disableSAX))
-            ctxt->sax->characters(ctxt->userData, out, i);
-	return;
-    }
+/**
+ * Free the entity templates of a parser context. Templates reference
+ * the entities of the current document and must be freed with it.
+ *
+ * @param ctxt  parser context
+ */
+void
+xmlCtxtFreeEntityTemplates(xmlParserCtxtPtr ctxt) {
+    xmlHashFree(ctxt->entTemplates, xmlFreeEntityTemplate);
+    ctxt->entTemplates = NULL;
+}
 
-    /*
-     * We are seeing an entity reference
+/*
+ * Returns the number of nodes in the content of an entity or -1 if
+ * it can't be copied from a template.
+ */
+static int
+xmlEntityTemplateCount(xmlParserCtxtPtr ctxt, xmlEntityPtr ent,
+                       int *maxDepth) {
+    xmlNodePtr cur = ent->children;
+    int depth = 0, count = 0;
+    xmlAttrPtr attr;
+
+    *maxDepth = 0;
+    while (cur != NULL) {
+        switch (cur->type) {
+            case XML_ELEMENT_NODE:
+                if ((cur->ns != NULL) || (cur->nsDef != NULL) ||
+                    (!xmlDictOwns(ctxt->dict, cur->name)))
+                    return(-1);
+                for (attr = cur->properties; attr != NULL; attr = attr->next)
+                    if (attr->ns != NULL)
+                        return(-1);
+                break;
+            case XML_PI_NODE:
+                if (!xmlDictOwns(ctxt->dict, cur->name))
+                    return(-1);
+                break;
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+            case XML_COMMENT_NODE:
+                break;
+            default:
+                return(-1);
+        }
+        if (count >= XML_MAX_ITEMS)
+            return(-1);
+        count++;
+
+        if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+            cur = cur->children;
+            depth++;
+            if (depth > *maxDepth)
+                *maxDepth = depth;
+            continue;
+        }
+        while ((cur->next == NULL) && (depth > 0)) {
+            cur = cur->parent;
+            depth--;
+        }
+        cur = cur->next;
+    }
+
+    return(count);
+}
+
+/*
+ * Returns the template of an entity or NULL if a memory allocation
+ * failed.
+ */
+static xmlEntityTemplate *
+xmlCtxtGetEntityTemplate(xmlParserCtxtPtr ctxt, xmlEntityPtr ent) {
+    xmlEntityTemplate *tmpl;
+    xmlEntityTemplateNode *node;
+    xmlNodePtr cur;
+    int depth, count, maxDepth;
+
+    if (ctxt->entTemplates == NULL) {
+        ctxt->entTemplates = xmlHashCreate(0);
+        if (ctxt->entTemplates == NULL)
+            return(NULL);
+    }
+
+    tmpl = xmlHashLookup(ctxt->entTemplates, ent->name);
+    if ((tmpl != NULL) && (tmpl->ent == ent) &&
+        (tmpl->children == ent->children))
+        return(tmpl);
+
+    tmpl = xmlMalloc(sizeof(*tmpl));
+    if (tmpl == NULL)
+        return(NULL);
+    memset(tmpl, 0, sizeof(*tmpl));
+    tmpl->ent = ent;
+    tmpl->children = ent->children;
+
+    count = -1;
+    if ((ctxt->myDoc != NULL) && (ctxt->myDoc->dict == ctxt->dict))
+        count = xmlEntityTemplateCount(ctxt, ent, &maxDepth);
+    if (count > 0) {
+        tmpl->nodes = xmlMalloc(count * sizeof(tmpl->nodes[0]));
+        if (tmpl->nodes == NULL) {
+            xmlFree(tmpl);
+            return(NULL);
+        }
+        tmpl->nbNodes = count;
+        tmpl->maxDepth = maxDepth;
+
+        node = tmpl->nodes;
+        cur = ent->children;
+        depth = 0;
+        while (cur != NULL) {
+            node->type = cur->type;
+            node->depth = depth;
+            node->name = cur->name;
+            node->content = cur->content;
+            node->len = xmlStrlen(cur->content);
+            node->shared = (cur->content != NULL) &&
+                           (xmlDictOwns(ctxt->dict, cur->content));
+            node->line = (cur->type == XML_ELEMENT_NODE) ? cur->line : 0;
+            node->properties = (cur->type == XML_ELEMENT_NODE) ?
+                               cur->properties : NULL;
+            node++;
+
+            if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+                cur = cur->children;
+                depth++;
+                continue;
+            }
+            while ((cur->next == NULL) && (depth > 0)) {
+                cur = cur->parent;
+                depth--;
+            }
+            cur = cur->next;
+        }
+    }
+
+    if (xmlHashUpdateEntry(ctxt->entTemplates, ent->name, tmpl,
+                           xmlFreeEntityTemplate) < 0) {
+        xmlFreeEntityTemplate(tmpl, NULL);
+        return(NULL);
+    }
+
+    return(tmpl);
+}
+
+/*
+ * Report text at the start or end of entity content with SAX to
+ * coalesce it with surrounding text.
+ */
+static void
+xmlEntityTemplateText(xmlParserCtxtPtr ctxt, xmlEntityTemplateNode *node) {
+    if ((node->type == XML_TEXT_NODE) ||
+        (ctxt->options & XML_PARSE_NOCDATA)) {
+        if (ctxt->sax->characters != NULL)
+            ctxt->sax->characters(ctxt, node->content, node->len);
+        xmlCtxtValidateText(ctxt, 0, node->content, node->len);
+    } else {
+        if (ctxt->sax->cdataBlock != NULL)
+            ctxt->sax->cdataBlock(ctxt, node->content, node->len);
+        xmlCtxtValidateText(ctxt, 1, node->content, node->len);
+    }
+}
+
+/*
+ * Add a copy of the entity content from the template to the current
+ * node.
+ */
+static void
+xmlCtxtInstantiateEntity(xmlParserCtxtPtr ctxt, xmlEntityTemplate *tmpl) {
+    xmlEntityTemplateNode *node = tmpl->nodes;
+    xmlNodePtr stackTab[16];
+    xmlNodePtr *stack = stackTab;
+    xmlDocPtr doc = ctxt->myDoc;
+    int first = 0, end = tmpl->nbNodes;
+    int i;
+
+    if ((node[0].type == XML_TEXT_NODE) ||
+        (node[0].type == XML_CDATA_SECTION_NODE)) {
+        xmlEntityTemplateText(ctxt, &node[0]);
+        first = 1;
+    }
+    if ((end > first) && (node[end - 1].depth == 0) &&
+        ((node[end - 1].type == XML_TEXT_NODE) ||
+         (node[end - 1].type == XML_CDATA_SECTION_NODE)))
+        end--;
+
+    if (first < end) {
+        if (tmpl->maxDepth + 2 > 16) {
+            stack = xmlMalloc((tmpl->maxDepth + 2) * sizeof(stack[0]));
+            if (stack == NULL) {
+                xmlErrMemory(ctxt);
+                return;
+            }
+        }
+        stack[0] = ctxt->node;
+
+        /* Reset coalesce buffer stats for non-text nodes */
+        ctxt->nodemem = 0;
+        ctxt->nodelen = 0;
+
+        for (i = first; i < end; i++) {
+            xmlNodePtr copy, parent;
+
+            copy = xmlTreeAlloc(doc, sizeof(xmlNode));
+            if (copy == NULL) {
+                xmlErrMemory(ctxt);
+                break;
+            }
+            memset(copy, 0, sizeof(xmlNode));
+            copy->type = node[i].type;
+            copy->doc = doc;
+            copy->name = node[i].name;
+            copy->line = node[i].line;
+            if (node[i].content != NULL) {
+                if (node[i].shared)
+                    copy->content = (xmlChar *) node[i].content;
+                else
+                    copy->content = xmlTreeStrndup(doc, node[i].content,
+                                                   node[i].len);
+                if (copy->content == NULL) {
+                    xmlFreeNode(copy);
+                    xmlErrMemory(ctxt);
+                    break;
+                }
+            }
+
+            parent = stack[node[i].depth];
+            copy->parent = parent;
+            if (parent->last == NULL) {
+                parent->children = copy;
+            } else {
+                parent->last->next = copy;
+                copy->prev = parent->last;
+            }
+            parent->last = copy;
+            stack[node[i].depth + 1] = copy;
+
+            if (node[i].properties != NULL) {
+                copy->properties = xmlCopyPropList(copy, node[i].properties);
+                if (copy->properties == NULL) {
+                    xmlErrMemory(ctxt);
+                    break;
+                }
+            }
+        }
+
+        if (stack != stackTab)
+            xmlFree(stack);
+        if (i < end)
+            return;
+    }
+
+    if (end < tmpl->nbNodes)
+        xmlEntityTemplateText(ctxt, &node[end]);
+}
+
+/**
+ * Parse and handle entity references in content, depending on the SAX
+ * interface, this may end-up in a call to character() if this is a
+ * CharRef, a predefined entity, if there is no reference() callback.
+ * or if the parser was asked to switch to that mode.
+ *
+ * @deprecated Internal function, don't use.
+ *
+ * Always consumes '&'.
+ *
+ *     [67] Reference ::= EntityRef | CharRef
+ * @param ctxt  an XML parser context
+ */
+void
+xmlParseReference(xmlParserCtxt *ctxt) {
+    xmlEntityPtr ent = NULL;
+    const xmlChar *name;
+    xmlChar *val;
+
+    if (RAW != '&')
+        return;
+
+    /*
+     * Simple case of a CharRef
+     */
+    if (NXT(1) == '#') {
+	int i = 0;
+	xmlChar out[16];
+	int value = xmlParseCharRef(ctxt);
+
+	if (value == 0)
+	    return;
+
+        /*
+         * Just encode the value in UTF-8
+         */
+        COPY_BUF(out, i, value);
+        out[i] = 0;
+        if ((ctxt->sax != NULL) && (ctxt->sax->characters != NULL) &&
+            (!ctxt->disableSAX))
+            ctxt->sax->characters(ctxt->userData, out, i);
+        xmlCtxtValidateText(ctxt, 0, out, i);
+	return;
+    }
+
+    /*
+     * We are seeing an entity reference
      */
     name = xmlParseEntityRefInternal(ctxt);
     if (name == NULL)
         return;
     ent = xmlLookupGeneralEntity(ctxt, name, /* isAttr */ 0);
+
+    /* Substituted entities don't match the source text */
+    if ((ctxt->replaceEntities) &&
+        ((ent == NULL) || (ent->etype != XML_INTERNAL_PREDEFINED_ENTITY)))
+        xmlCtxtInvalidateSourceSpans(ctxt, 0);
+
     if (ent == NULL) {
         /*
          * Create a reference for undeclared entities.
@@ -7156,6 +7843,7 @@ xmlParseReference(xmlParserCtxt *ctxt) {
 	if ((ctxt->sax != NULL) && (ctxt->sax->characters != NULL) &&
 	    (!ctxt->disableSAX))
 	    ctxt->sax->characters(ctxt->userData, val, xmlStrlen(val));
+        xmlCtxtValidateText(ctxt, 0, val, xmlStrlen(val));
 	return;
     }
 
@@ -7213,7 +7901,8 @@ xmlParseReference(xmlParserCtxt *ctxt) {
           (ctxt->validate)))) {
         if ((ent->flags & XML_ENT_PARSED) == 0) {
             xmlCtxtParseEntity(ctxt, ent);
-        } else if (ent->children == NULL) {
+        } else if ((ent->children == NULL) &&
+                   ((ent->flags & XML_ENT_SHARED) == 0)) {
             /*
              * Probably running in SAX mode and the callbacks don't
              * build the entity content. Parse the entity again.
@@ -7243,9 +7932,27 @@ xmlParseReference(xmlParserCtxt *ctxt) {
 	 */
         if (ctxt->sax->reference != NULL)
 	    ctxt->sax->reference(ctxt->userData, ent->name);
-    } else if ((ent->children != NULL) && (ctxt->node != NULL)) {
+    } else if ((ent->children != NULL) && (ctxt->node != NULL) &&
+               (!PARSER_FILTERED(ctxt))) {
         xmlNodePtr copy, cur;
 
+        /*
+         * The reader needs the flags of the copied nodes
+         */
+        if ((ctxt->parseMode != XML_PARSE_READER) &&
+            (!xmlRegisterCallbacks)) {
+            xmlEntityTemplate *tmpl = xmlCtxtGetEntityTemplate(ctxt, ent);
+
+            if (tmpl == NULL) {
+                xmlErrMemory(ctxt);
+                return;
+            }
+            if (tmpl->nodes != NULL) {
+                xmlCtxtInstantiateEntity(ctxt, tmpl);
+                return;
+            }
+        }
+
         /*
          * Seems we are generating the DOM content, copy the tree
 	 */
@@ -7262,9 +7969,11 @@ xmlParseReference(xmlParserCtxt *ctxt) {
                 (ctxt->options & XML_PARSE_NOCDATA)) {
                 if (ctxt->sax->characters != NULL)
                     ctxt->sax->characters(ctxt, cur->content, len);
+                xmlCtxtValidateText(ctxt, 0, cur->content, len);
             } else {
                 if (ctxt->sax->cdataBlock != NULL)
                     ctxt->sax->cdataBlock(ctxt, cur->content, len);
+                xmlCtxtValidateText(ctxt, 1, cur->content, len);
             }
 
             cur = cur->next;
@@ -7285,9 +7994,11 @@ xmlParseReference(xmlParserCtxt *ctxt) {
                     (ctxt->options & XML_PARSE_NOCDATA)) {
                     if (ctxt->sax->characters != NULL)
                         ctxt->sax->characters(ctxt, cur->content, len);
+                    xmlCtxtValidateText(ctxt, 0, cur->content, len);
                 } else {
                     if (ctxt->sax->cdataBlock != NULL)
                         ctxt->sax->cdataBlock(ctxt, cur->content, len);
+                    xmlCtxtValidateText(ctxt, 1, cur->content, len);
                 }
 
                 break;
@@ -7765,6 +8476,7 @@ xmlLoadEntityContent(xmlParserCtxtPtr ctxt, xmlEntityPtr entity) {
     }
 
     length = input->cur - input->base;
+    xmlParserInputSyncLines(input);
     xmlBufShrink(input->buf->buffer, length);
     xmlSaturatedAdd(&ctxt->sizeentities, length);
 
@@ -8511,7 +9223,7 @@ xmlParseQNameAndCompare(xmlParserCtxtPtr ctxt, xmlChar const *name,
  * Parse an attribute in the new SAX2 framework.
  *
  * @param ctxt  an XML parser context
- * @param pref  the element prefix
+ * @param plan  the attribute plan of the element or NULL
  * @param elem  the element name
  * @param hprefix  resulting attribute prefix
  * @param value  resulting value of the attribute
@@ -8522,7 +9234,7 @@ xmlParseQNameAndCompare(xmlParserCtxtPtr ctxt, xmlChar const *name,
 
 static xmlHashedString
 xmlParseAttribute2(xmlParserCtxtPtr ctxt,
-                   const xmlChar * pref, const xmlChar * elem,
+                   const xmlAttrPlan *plan, const xmlChar * elem,
                    xmlHashedString * hprefix, xmlChar ** value,
                    int *len, int *alloc)
 {
@@ -8547,10 +9259,7 @@ xmlParseAttribute2(xmlParserCtxtPtr ctxt,
     /*
      * get the type if needed
      */
-    if (ctxt->attsSpecial != NULL) {
-        special = XML_PTR_TO_INT(xmlHashQLookup2(ctxt->attsSpecial, pref, elem,
-                                              prefix, name));
-    }
+    special = xmlAttrPlanSpecialType(plan, prefix, name);
 
     /*
      * read the value
@@ -8758,6 +9467,7 @@ xmlParseStartTag2(xmlParserCtxtPtr ctxt, const xmlChar **pref,
     const xmlChar *uri;
     xmlChar *attvalue = NULL;
     const xmlChar **atts = ctxt->atts;
+    const xmlAttrPlan *plan;
     unsigned attrHashSize = 0;
     int maxatts = ctxt->maxatts;
     int nratts, nbatts, nbdef;
@@ -8789,6 +9499,7 @@ xmlParseStartTag2(xmlParserCtxtPtr ctxt, const xmlChar **pref,
     }
     localname = hlocalname.name;
     prefix = hprefix.name;
+    plan = xmlCtxtLookupAttrPlan(ctxt, localname, prefix);
 
     /*
      * Now parse the attributes, it ends up with the ending
@@ -8827,7 +9538,7 @@ xmlParseStartTag2(xmlParserCtxtPtr ctxt, const xmlChar **pref,
 	   (IS_BYTE_CHAR(RAW))) && (PARSER_STOPPED(ctxt) == 0)) {
 	int len = -1;
 
-	hattname = xmlParseAttribute2(ctxt, prefix, localname,
+	hattname = xmlParseAttribute2(ctxt, plan, localname,
                                           &haprefix, &attvalue, &len,
                                           &alloc);
         if (hattname.name == NULL)
@@ -9015,11 +9726,18 @@ next_attr:
     /*
      * Namespaces from default attributes
      */
-    if (ctxt->attsDefault != NULL) {
-        xmlDefAttrsPtr defaults;
-
-	defaults = xmlHashLookup2(ctxt->attsDefault, localname, prefix);
-	if (defaults != NULL) {
+    if ((plan != NULL) && (plan->defaults != NULL)) {
+        xmlDefAttrsPtr defaults = plan->defaults;
+
+	if (plan->nsDefaults == 0) {
+            nbTotalDef = defaults->nbAttrs;
+            if (nratts + nbTotalDef > XML_MAX_ATTRS) {
+                xmlFatalErr(ctxt, XML_ERR_RESOURCE_LIMIT,
+                            "Maximum number of attributes exceeded");
+                nbTotalDef = (nratts < XML_MAX_ATTRS) ?
+                             XML_MAX_ATTRS - nratts : 0;
+            }
+        } else {
 	    for (i = 0; i < defaults->nbAttrs; i++) {
                 xmlDefAttr *attr = &defaults->attrs[i];
 
@@ -9029,14 +9747,19 @@ next_attr:
 		if ((attname == ctxt->str_xmlns) && (aprefix == NULL)) {
                     xmlParserEntityCheck(ctxt, attr->expandedSize);
 
-                    if (xmlParserNsPush(ctxt, NULL, &attr->value, NULL, 1) > 0)
+                    if (xmlParserNsPush(ctxt, NULL, &attr->value,
+                                        NULL, 1) > 0) {
+                        xmlCtxtInvalidateSourceSpans(ctxt, 1);
                         nbNs++;
+                    }
 		} else if (aprefix == ctxt->str_xmlns) {
                     xmlParserEntityCheck(ctxt, attr->expandedSize);
 
                     if (xmlParserNsPush(ctxt, &attr->name, &attr->value,
-                                      NULL, 1) > 0)
+                                      NULL, 1) > 0) {
+                        xmlCtxtInvalidateSourceSpans(ctxt, 1);
                         nbNs++;
+                    }
 		} else {
                     if (nratts + nbTotalDef >= XML_MAX_ATTRS) {
                         xmlFatalErr(ctxt, XML_ERR_RESOURCE_LIMIT,
@@ -9164,10 +9887,9 @@ next_attr:
     /*
      * Default attributes
      */
-    if (ctxt->attsDefault != NULL) {
-        xmlDefAttrsPtr defaults;
+    if (plan != NULL) {
+        xmlDefAttrsPtr defaults = plan->defaults;
 
-	defaults = xmlHashLookup2(ctxt->attsDefault, localname, prefix);
 	if (defaults != NULL) {
 	    for (i = 0; i < defaults->nbAttrs; i++) {
                 xmlDefAttr *attr = &defaults->attrs[i];
@@ -9266,6 +9988,10 @@ next_attr:
 	}
     }
 
+    /* Defaulted attributes aren't in the source text */
+    if ((nbdef > 0) && (ctxt->loadsubset & XML_COMPLETE_ATTRS))
+        xmlCtxtInvalidateSourceSpans(ctxt, 1);
+
     /*
      * Using a single hash table for nsUri/localName pairs cannot
      * detect duplicate QNames reliably. The following example will
@@ -9344,6 +10070,14 @@ next_attr:
 	    ctxt->sax->startElementNs(ctxt->userData, localname, prefix, uri,
                           0, NULL, nbatts / 5, nbdef, atts);
     }
+#ifdef LIBXML_SCHEMAS_ENABLED
+    if ((ctxt->schemaValid != NULL) && (!ctxt->disableSAX))
+        xmlSchemaValidateStartTag(ctxt->schemaValid, localname, uri, nbNs,
+                                  nbNs > 0 ?
+                                      ctxt->nsTab + 2 * (ctxt->nsNr - nbNs) :
+                                      NULL,
+                                  nbatts / 5, atts);
+#endif
 
 done:
     /*
@@ -9417,12 +10151,38 @@ xmlParseEndTag2(xmlParserCtxtPtr ctxt, const xmlStartTag *tag) {
 	(!ctxt->disableSAX))
 	ctxt->sax->endElementNs(ctxt->userData, ctxt->name, tag->prefix,
                                 tag->URI);
+#ifdef LIBXML_SCHEMAS_ENABLED
+    if ((ctxt->schemaValid != NULL) && (!ctxt->disableSAX))
+        xmlSchemaValidateEndTag(ctxt->schemaValid, ctxt->name, tag->URI);
+#endif
 
     spacePop(ctxt);
     if (tag->nsNr != 0)
 	xmlParserNsPop(ctxt, tag->nsNr);
 }
 
+/*
+ * Report the content of a CDATA section. `flags` tells whether the
+ * content continues in the next call, see #xmlCtxtIsTextPartial.
+ */
+static void
+xmlCDataBlock(xmlParserCtxtPtr ctxt, const xmlChar *buf, int len,
+              unsigned flags) {
+    if ((ctxt->sax == NULL) || (ctxt->disableSAX))
+        return;
+
+    ctxt->partialText = flags;
+    if ((ctxt->sax->cdataBlock != NULL) &&
+        ((ctxt->options & XML_PARSE_NOCDATA) == 0)) {
+        ctxt->sax->cdataBlock(ctxt->userData, buf, len);
+    } else if (ctxt->sax->characters != NULL) {
+        ctxt->sax->characters(ctxt->userData, buf, len);
+    }
+    xmlCtxtValidateText(ctxt, (ctxt->options & XML_PARSE_NOCDATA) == 0,
+                        buf, len);
+    ctxt->partialText = 0;
+}
+
 /**
  * Parse escaped pure raw content. Always consumes '<!['.
  *
@@ -9445,6 +10205,7 @@ xmlParseCDSect(xmlParserCtxt *ctxt) {
     int r, rl;
     int	s, sl;
     int cur, l;
+    unsigned flags = 0;
     int maxLength = (ctxt->options & XML_PARSE_HUGE) ?
                     XML_MAX_HUGE_LENGTH :
                     XML_MAX_TEXT_LENGTH;
@@ -9477,6 +10238,14 @@ xmlParseCDSect(xmlParserCtxt *ctxt) {
     }
     while (IS_CHAR(cur) &&
            ((r != ']') || (s != ']') || (cur != '>'))) {
+        if ((ctxt->chunkedText) && (len >= XML_TEXT_CHUNK_SIZE)) {
+            buf[len] = 0;
+            xmlCDataBlock(ctxt, buf, len, flags | XML_TEXT_MORE);
+            if (PARSER_STOPPED(ctxt))
+                goto out;
+            flags = XML_TEXT_CONTINUED;
+            len = 0;
+        }
 	if (len + 5 >= size) {
 	    xmlChar *tmp;
             int newSize;
@@ -9514,14 +10283,7 @@ xmlParseCDSect(xmlParserCtxt *ctxt) {
     /*
      * OK the buffer is to be consumed as cdata.
      */
-    if ((ctxt->sax != NULL) && (!ctxt->disableSAX)) {
-        if ((ctxt->sax->cdataBlock != NULL) &&
-            ((ctxt->options & XML_PARSE_NOCDATA) == 0)) {
-            ctxt->sax->cdataBlock(ctxt->userData, buf, len);
-        } else if (ctxt->sax->characters != NULL) {
-            ctxt->sax->characters(ctxt->userData, buf, len);
-        }
-    }
+    xmlCDataBlock(ctxt, buf, len, flags);
 
 out:
     xmlFree(buf);
@@ -9685,61 +10447,370 @@ xmlParseElement(xmlParserCtxt *ctxt) {
     xmlParseElementEnd(ctxt);
 }
 
+/*
+ * Source spans of the elements in the document entity, recorded
+ * while parsing if #xmlCtxtSetSourceSpans was enabled. Spans of open
+ * elements have an end offset of zero. The first `nbInvalid` open
+ * elements don't match their source and get no span when closed.
+ */
+typedef struct {
+    xmlSourceSpan *spans;
+    int nbSpans;
+    int maxSpans;
+    int *open;
+    int nbOpen;
+    int maxOpen;
+    int nbInvalid;
+    int skipNext;
+    int failed;
+} xmlSourceBuilder;
+
 /**
- * Parse the start of an XML element. Returns -1 in case of error, 0 if an
- * opening tag was parsed, 1 if an empty element was parsed.
- *
- * Always consumes '<'.
+ * Free the source spans recorded by the parser.
  *
  * @param ctxt  an XML parser context
  */
-static int
-xmlParseElementStart(xmlParserCtxtPtr ctxt) {
-    int maxDepth = (ctxt->options & XML_PARSE_HUGE) ? 2048 : 256;
-    const xmlChar *name;
-    const xmlChar *prefix = NULL;
-    const xmlChar *URI = NULL;
-    xmlParserNodeInfo node_info;
-    int line;
-    xmlNodePtr cur;
-    int nbNs = 0;
+void
+xmlCtxtFreeSourceSpans(xmlParserCtxtPtr ctxt) {
+    xmlSourceBuilder *builder = ctxt->sourceSpans;
 
-    if (ctxt->nameNr > maxDepth) {
-        xmlFatalErrMsgInt(ctxt, XML_ERR_RESOURCE_LIMIT,
-                "Excessive depth in document: %d use XML_PARSE_HUGE option\n",
-                ctxt->nameNr);
-	return(-1);
-    }
+    if (builder == NULL)
+        return;
 
-    /* Capture start position */
-    if (ctxt->record_info) {
-        node_info.begin_pos = ctxt->input->consumed +
-                          (CUR_PTR - ctxt->input->base);
-	node_info.begin_line = ctxt->input->line;
+    xmlFree(builder->spans);
+    xmlFree(builder->open);
+    xmlFree(builder);
+    ctxt->sourceSpans = NULL;
+}
+
+static xmlSourceBuilder *
+xmlCtxtGetSourceBuilder(xmlParserCtxtPtr ctxt) {
+    xmlSourceBuilder *builder = ctxt->sourceSpans;
+
+    if (builder == NULL) {
+        builder = xmlMalloc(sizeof(*builder));
+        if (builder == NULL) {
+            xmlCtxtErrMemory(ctxt);
+            return(NULL);
+        }
+        memset(builder, 0, sizeof(*builder));
+        ctxt->sourceSpans = builder;
     }
+    if (builder->failed)
+        return(NULL);
 
-    if (ctxt->spaceNr == 0)
-	spacePush(ctxt, -1);
-    else if (*ctxt->space == -2)
-	spacePush(ctxt, -1);
-    else
-	spacePush(ctxt, *ctxt->space);
+    return(builder);
+}
+
+/**
+ * Note that the tree won't match the source text of the open
+ * elements, for example because an entity reference was substituted.
+ * If `next` is set, this also applies to the element whose start tag
+ * is being parsed, for example because it has defaulted attributes.
+ *
+ * @param ctxt  an XML parser context
+ * @param next  whether the next element is affected
+ */
+static void
+xmlCtxtInvalidateSourceSpans(xmlParserCtxtPtr ctxt, int next) {
+    xmlSourceBuilder *builder;
+
+    if ((!ctxt->keepSource) || (ctxt->inputNr != 1))
+        return;
+
+    builder = xmlCtxtGetSourceBuilder(ctxt);
+    if (builder == NULL)
+        return;
+
+    builder->nbInvalid = builder->nbOpen;
+    if (next)
+        builder->skipNext = 1;
+}
 
-    line = ctxt->input->line;
-#ifdef LIBXML_SAX1_ENABLED
-    if (ctxt->sax2)
-#endif /* LIBXML_SAX1_ENABLED */
-        name = xmlParseStartTag2(ctxt, &prefix, &URI, &nbNs);
 #ifdef LIBXML_SAX1_ENABLED
-    else
-	name = xmlParseStartTag(ctxt);
-#endif /* LIBXML_SAX1_ENABLED */
-    if (name == NULL) {
-	spacePop(ctxt);
-        return(-1);
+/*
+ * With SAX1, default attributes are added by the SAX handler. Check
+ * whether the DTD declares any which end up in the tree.
+ */
+static int
+xmlSAX1HasDefaultAttrs(xmlParserCtxtPtr ctxt, const xmlChar *name) {
+    xmlDtdPtr dtds[2];
+    int i;
+
+    if (ctxt->myDoc == NULL)
+        return(0);
+    dtds[0] = ctxt->myDoc->intSubset;
+    dtds[1] = ctxt->myDoc->extSubset;
+
+    for (i = 0; i < 2; i++) {
+        xmlElementPtr elem = xmlGetDtdElementDesc(dtds[i], name);
+        xmlAttributePtr attr;
+
+        if (elem == NULL)
+            continue;
+        for (attr = elem->attributes; attr != NULL; attr = attr->nexth) {
+            if ((attr->defaultValue != NULL) &&
+                ((ctxt->loadsubset & XML_COMPLETE_ATTRS) ||
+                 (xmlStrEqual(attr->prefix, BAD_CAST "xmlns")) ||
+                 ((attr->prefix == NULL) &&
+                  (xmlStrEqual(attr->name, BAD_CAST "xmlns")))))
+                return(1);
+        }
     }
-    nameNsPush(ctxt, name, prefix, URI, line, nbNs);
-    cur = ctxt->node;
+
+    return(0);
+}
+#endif /* LIBXML_SAX1_ENABLED */
+
+/**
+ * Record the source span of an element. If `closed` is zero, the
+ * element is open and its span is completed by #xmlCtxtCloseSourceSpan.
+ *
+ * @param ctxt  an XML parser context
+ * @param node  the element
+ * @param start  offset of the start tag
+ * @param closed  whether the element was empty
+ */
+static void
+xmlCtxtAddSourceSpan(xmlParserCtxtPtr ctxt, xmlNodePtr node, size_t start,
+                     int closed) {
+    xmlSourceBuilder *builder;
+    xmlSourceSpan *span;
+    int skip;
+
+    builder = xmlCtxtGetSourceBuilder(ctxt);
+    if (builder == NULL)
+        return;
+
+    skip = builder->skipNext;
+    builder->skipNext = 0;
+    if ((skip) && (closed))
+        return;
+
+    if (builder->nbSpans >= builder->maxSpans) {
+        xmlSourceSpan *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(builder->maxSpans, sizeof(tmp[0]),
+                                  64, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            xmlCtxtErrMemory(ctxt);
+            builder->failed = 1;
+            return;
+        }
+        tmp = xmlRealloc(builder->spans, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlCtxtErrMemory(ctxt);
+            builder->failed = 1;
+            return;
+        }
+        builder->spans = tmp;
+        builder->maxSpans = newSize;
+    }
+
+    if ((!closed) && (builder->nbOpen >= builder->maxOpen)) {
+        int *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(builder->maxOpen, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            xmlCtxtErrMemory(ctxt);
+            builder->failed = 1;
+            return;
+        }
+        tmp = xmlRealloc(builder->open, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlCtxtErrMemory(ctxt);
+            builder->failed = 1;
+            return;
+        }
+        builder->open = tmp;
+        builder->maxOpen = newSize;
+    }
+
+    span = &builder->spans[builder->nbSpans];
+    span->node = node;
+    span->start = start;
+    if (closed) {
+        span->end = ctxt->input->consumed + (CUR_PTR - ctxt->input->base);
+    } else {
+        span->end = 0;
+        builder->open[builder->nbOpen++] = builder->nbSpans;
+        if (skip)
+            builder->nbInvalid = builder->nbOpen;
+    }
+    builder->nbSpans++;
+}
+
+/**
+ * Complete the source span of an element after its end tag.
+ *
+ * @param ctxt  an XML parser context
+ * @param node  the element
+ */
+static void
+xmlCtxtCloseSourceSpan(xmlParserCtxtPtr ctxt, xmlNodePtr node) {
+    xmlSourceBuilder *builder = ctxt->sourceSpans;
+    xmlSourceSpan *span;
+
+    if ((builder == NULL) || (builder->failed))
+        return;
+
+    if (builder->nbOpen <= 0) {
+        builder->failed = 1;
+        return;
+    }
+    span = &builder->spans[builder->open[--builder->nbOpen]];
+    if (span->node != node) {
+        builder->failed = 1;
+        return;
+    }
+    if (builder->nbOpen < builder->nbInvalid) {
+        /* An end offset of zero is dropped by xmlCtxtAttachSource */
+        builder->nbInvalid = builder->nbOpen;
+        return;
+    }
+    span->end = ctxt->input->consumed + (CUR_PTR - ctxt->input->base);
+}
+
+static int
+xmlSourceSpanCmp(const void *a, const void *b) {
+    XML_INTPTR_T na = (XML_INTPTR_T) ((const xmlSourceSpan *) a)->node;
+    XML_INTPTR_T nb = (XML_INTPTR_T) ((const xmlSourceSpan *) b)->node;
+
+    return((na > nb) - (na < nb));
+}
+
+/**
+ * Hand the text of the document entity and the recorded spans over
+ * to the parsed document. Nothing is attached if the document isn't
+ * well-formed.
+ *
+ * @param ctxt  an XML parser context
+ * @param doc  the parsed document
+ */
+static void
+xmlCtxtAttachSource(xmlParserCtxtPtr ctxt, xmlDocPtr doc) {
+    xmlSourceBuilder *builder = ctxt->sourceSpans;
+    xmlParserInputPtr input;
+    xmlDocSource *src;
+    size_t offset;
+    int i, j;
+
+    if ((builder == NULL) || (builder->failed) || (builder->nbOpen != 0) ||
+        (!ctxt->wellFormed) || (doc->source != NULL) ||
+        (ctxt->inputNr < 1) || (ctxt->inputTab[0]->buf == NULL))
+        goto done;
+    input = ctxt->inputTab[0];
+
+    src = xmlMalloc(sizeof(*src));
+    if (src == NULL) {
+        xmlCtxtErrMemory(ctxt);
+        goto done;
+    }
+    memset(src, 0, sizeof(*src));
+
+    if (xmlParserInputBufferTakeContent(input->buf, &src->text, &src->size,
+                                        &src->release,
+                                        &src->releaseCtxt) < 0) {
+        xmlCtxtErrMemory(ctxt);
+        xmlFree(src);
+        goto done;
+    }
+
+    /* Spans are relative to the start of the input, the text isn't. */
+    offset = input->consumed;
+    for (i = 0, j = 0; i < builder->nbSpans; i++) {
+        xmlSourceSpan *span = &builder->spans[i];
+
+        if ((span->node == NULL) ||
+            (span->start < offset) ||
+            (span->end <= span->start) ||
+            (span->end - offset > src->size))
+            continue;
+        builder->spans[j].node = span->node;
+        builder->spans[j].start = span->start - offset;
+        builder->spans[j].end = span->end - offset;
+        j++;
+    }
+    qsort(builder->spans, j, sizeof(builder->spans[0]), xmlSourceSpanCmp);
+
+    src->spans = builder->spans;
+    src->nbSpans = j;
+    builder->spans = NULL;
+    doc->source = src;
+
+done:
+    xmlCtxtFreeSourceSpans(ctxt);
+}
+
+/**
+ * Parse the start of an XML element. Returns -1 in case of error, 0 if an
+ * opening tag was parsed, 1 if an empty element was parsed.
+ *
+ * Always consumes '<'.
+ *
+ * @param ctxt  an XML parser context
+ */
+static int
+xmlParseElementStart(xmlParserCtxtPtr ctxt) {
+    int maxDepth = (ctxt->options & XML_PARSE_HUGE) ? 2048 : 256;
+    const xmlChar *name;
+    const xmlChar *prefix = NULL;
+    const xmlChar *URI = NULL;
+    xmlParserNodeInfo node_info;
+    int line;
+    xmlNodePtr cur;
+    int nbNs = 0;
+    int keepSource = (ctxt->keepSource) && (ctxt->inputNr == 1);
+    size_t sourceStart = 0;
+
+    if (ctxt->nameNr > maxDepth) {
+        xmlFatalErrMsgInt(ctxt, XML_ERR_RESOURCE_LIMIT,
+                "Excessive depth in document: %d use XML_PARSE_HUGE option\n",
+                ctxt->nameNr);
+	return(-1);
+    }
+    if (PARSER_INTERRUPTED(ctxt))
+        return(-1);
+
+    /* Capture start position */
+    xmlParserInputSyncLines(ctxt->input);
+    if (ctxt->record_info) {
+        node_info.begin_pos = ctxt->input->consumed +
+                          (CUR_PTR - ctxt->input->base);
+	node_info.begin_line = ctxt->input->line;
+    }
+    if (keepSource)
+        sourceStart = ctxt->input->consumed + (CUR_PTR - ctxt->input->base);
+
+    if (ctxt->spaceNr == 0)
+	spacePush(ctxt, -1);
+    else if (*ctxt->space == -2)
+	spacePush(ctxt, -1);
+    else
+	spacePush(ctxt, *ctxt->space);
+
+    line = ctxt->input->line;
+#ifdef LIBXML_SAX1_ENABLED
+    if (ctxt->sax2)
+#endif /* LIBXML_SAX1_ENABLED */
+        name = xmlParseStartTag2(ctxt, &prefix, &URI, &nbNs);
+#ifdef LIBXML_SAX1_ENABLED
+    else {
+	name = xmlParseStartTag(ctxt);
+        if ((name != NULL) && (keepSource) &&
+            (xmlSAX1HasDefaultAttrs(ctxt, name)))
+            xmlCtxtInvalidateSourceSpans(ctxt, 1);
+    }
+#endif /* LIBXML_SAX1_ENABLED */
+    if (name == NULL) {
+	spacePop(ctxt);
+        return(-1);
+    }
+    nameNsPush(ctxt, name, prefix, URI, line, nbNs);
+    cur = ctxt->node;
 
 #ifdef LIBXML_VALID_ENABLED
     /*
@@ -9761,6 +10832,10 @@ xmlParseElementStart(xmlParserCtxtPtr ctxt) {
 	    if ((ctxt->sax != NULL) && (ctxt->sax->endElementNs != NULL) &&
 		(!ctxt->disableSAX))
 		ctxt->sax->endElementNs(ctxt->userData, name, prefix, URI);
+#ifdef LIBXML_SCHEMAS_ENABLED
+	    if ((ctxt->schemaValid != NULL) && (!ctxt->disableSAX))
+		xmlSchemaValidateEndTag(ctxt->schemaValid, name, URI);
+#endif
 #ifdef LIBXML_SAX1_ENABLED
 	} else {
 	    if ((ctxt->sax != NULL) && (ctxt->sax->endElement != NULL) &&
@@ -9776,9 +10851,12 @@ xmlParseElementStart(xmlParserCtxtPtr ctxt) {
             node_info.node = cur;
             node_info.end_pos = ctxt->input->consumed +
                                 (CUR_PTR - ctxt->input->base);
+            xmlParserInputSyncLines(ctxt->input);
             node_info.end_line = ctxt->input->line;
             xmlParserAddNodeInfo(ctxt, &node_info);
 	}
+        if ((cur != NULL) && (keepSource))
+            xmlCtxtAddSourceSpan(ctxt, cur, sourceStart, 1);
 	return(1);
     }
     if (RAW == '>') {
@@ -9789,6 +10867,8 @@ xmlParseElementStart(xmlParserCtxtPtr ctxt) {
             node_info.end_line = 0;
             xmlParserAddNodeInfo(ctxt, &node_info);
         }
+        if ((cur != NULL) && (keepSource))
+            xmlCtxtAddSourceSpan(ctxt, cur, sourceStart, 0);
     } else {
         xmlFatalErrMsgStrIntStr(ctxt, XML_ERR_GT_REQUIRED,
 		     "Couldn't find end of Start Tag %s line %d\n",
@@ -9845,9 +10925,13 @@ xmlParseElementEnd(xmlParserCtxtPtr ctxt) {
         if (node_info != NULL) {
             node_info->end_pos = ctxt->input->consumed +
                                  (CUR_PTR - ctxt->input->base);
+            xmlParserInputSyncLines(ctxt->input);
             node_info->end_line = ctxt->input->line;
         }
     }
+
+    if ((cur != NULL) && (ctxt->keepSource) && (ctxt->inputNr == 1))
+        xmlCtxtCloseSourceSpan(ctxt, cur);
 }
 
 /**
@@ -10366,17 +11450,8 @@ xmlFinishDocument(xmlParserCtxtPtr ctxt) {
     }
 }
 
-/**
- * Parse an XML document and invoke the SAX handlers. This is useful
- * if you're only interested in custom SAX callbacks. If you want a
- * document tree, use #xmlCtxtParseDocument.
- *
- * @param ctxt  an XML parser context
- * @returns 0, -1 in case of error.
- */
-
-int
-xmlParseDocument(xmlParserCtxt *ctxt) {
+static int
+xmlParseDocumentInternal(xmlParserCtxt *ctxt) {
     if ((ctxt == NULL) || (ctxt->input == NULL))
         return(-1);
 
@@ -10486,6 +11561,39 @@ xmlParseDocument(xmlParserCtxt *ctxt) {
     return(0);
 }
 
+/**
+ * Parse an XML document and invoke the SAX handlers. This is useful
+ * if you're only interested in custom SAX callbacks. If you want a
+ * document tree, use #xmlCtxtParseDocument.
+ *
+ * @param ctxt  an XML parser context
+ * @returns 0, -1 in case of error.
+ */
+
+int
+xmlParseDocument(xmlParserCtxt *ctxt) {
+    xmlMemBudget *oldBudget;
+    int res;
+
+    const char *url;
+    double start;
+
+    if ((ctxt == NULL) || (ctxt->input == NULL))
+        return(-1);
+
+    url = ctxt->input->filename;
+    XML_TRACE_BEGIN(doc, XML_TRACE_DOC_START, url, start);
+
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+    res = xmlParseDocumentInternal(ctxt);
+    xmlMemBudgetLeave(oldBudget);
+
+    XML_TRACE_END(doc, XML_TRACE_DOC_END, url, xmlCtxtTraceBytes(ctxt),
+                  start);
+
+    return(res);
+}
+
 /**
  * Parse a general parsed entity
  * An external general parsed entity is well-formed if it matches the
@@ -10564,6 +11672,19 @@ xmlParseExtParsedEnt(xmlParserCtxt *ctxt) {
  *									*
  ************************************************************************/
 
+/*
+ * Characters which stop the lookahead scans. The scans resume at the
+ * saved offset in checkIndex when more data arrives.
+ */
+static const xmlAsciiSet xmlLookupGtSet = XML_ASCII_SET(
+    0,
+    1u << ('"' - 32) | 1u << ('\'' - 32) | 1u << ('>' - 32)
+);
+static const xmlAsciiSet xmlLookupCharDataSet = XML_ASCII_SET(
+    0,
+    1u << ('&' - 32) | 1u << ('<' - 32)
+);
+
 /**
  * Check whether the input buffer contains a character.
  *
@@ -10649,6 +11770,11 @@ xmlParseLookupCharData(xmlParserCtxtPtr ctxt) {
     size_t index;
 
     while (cur < end) {
+        if (end - cur >= 16) {
+            cur = xmlScanAsciiSet(cur, end, &xmlLookupCharDataSet);
+            if (cur >= end)
+                break;
+        }
         if ((*cur == '<') || (*cur == '&')) {
             ctxt->checkIndex = 0;
             return(1);
@@ -10685,9 +11811,22 @@ xmlParseLookupGt(xmlParserCtxtPtr ctxt) {
 
     while (cur < end) {
         if (state) {
-            if (*cur == state)
-                state = 0;
-        } else if (*cur == '\'' || *cur == '"') {
+            cur = memchr(cur, state, end - cur);
+            if (cur == NULL) {
+                cur = end;
+                break;
+            }
+            state = 0;
+            cur++;
+            continue;
+        }
+
+        if (end - cur >= 16) {
+            cur = xmlScanAsciiSet(cur, end, &xmlLookupGtSet);
+            if (cur >= end)
+                break;
+        }
+        if (*cur == '\'' || *cur == '"') {
             state = *cur;
         } else if (*cur == '>') {
             ctxt->checkIndex = 0;
@@ -10824,6 +11963,31 @@ xmlParseLookupInternalSubset(xmlParserCtxtPtr ctxt) {
  * @param terminate  last chunk indicator
  * @returns zero if no parsing was possible
  */
+/**
+ * Pass a completed document of a stream to the callback and prepare
+ * the context for the next document.
+ *
+ * @param ctxt  an XML parser context
+ */
+static void
+xmlParseEndStreamDoc(xmlParserCtxtPtr ctxt) {
+    xmlDocPtr doc;
+    int status;
+
+    xmlFinishDocument(ctxt);
+
+    doc = ctxt->myDoc;
+    ctxt->myDoc = NULL;
+    status = ctxt->wellFormed ? XML_ERR_OK : ctxt->errNo;
+
+    xmlCtxtResetDocument(ctxt);
+    ctxt->instate = XML_PARSER_XML_DECL;
+    ctxt->streamDocs++;
+
+    if (ctxt->docStream(ctxt->docStreamData, doc, status) < 0)
+        xmlStopParser(ctxt);
+}
+
 static int
 xmlParseTryOrFinish(xmlParserCtxtPtr ctxt, int terminate) {
     int ret = 0;
@@ -10839,6 +12003,11 @@ xmlParseTryOrFinish(xmlParserCtxtPtr ctxt, int terminate) {
     }
 
     while (ctxt->disableSAX == 0) {
+        if ((ctxt->instate == XML_PARSER_EPILOG) &&
+            (ctxt->docStream != NULL)) {
+            xmlParseEndStreamDoc(ctxt);
+            continue;
+        }
         avail = ctxt->input->end - ctxt->input->cur;
         if (avail < 1)
 	    goto done;
@@ -10868,6 +12037,13 @@ xmlParseTryOrFinish(xmlParserCtxtPtr ctxt, int terminate) {
 		break;
 
             case XML_PARSER_XML_DECL:
+                if (ctxt->streamDocs > 0) {
+                    /* Whitespace between documents of a stream */
+                    SKIP_BLANKS;
+                    avail = ctxt->input->end - ctxt->input->cur;
+                    if (avail < 1)
+                        goto done;
+                }
 		if ((!terminate) && (avail < 2))
 		    goto done;
 		cur = ctxt->input->cur[0];
@@ -10910,11 +12086,13 @@ xmlParseTryOrFinish(xmlParserCtxtPtr ctxt, int terminate) {
 	        const xmlChar *name;
 		const xmlChar *prefix = NULL;
 		const xmlChar *URI = NULL;
-                int line = ctxt->input->line;
+                int line;
 		int nbNs = 0;
 
 		if ((!terminate) && (avail < 2))
 		    goto done;
+                xmlParserInputSyncLines(ctxt->input);
+                line = ctxt->input->line;
 		cur = ctxt->input->cur[0];
 	        if (cur != '<') {
 		    xmlFatalErrMsg(ctxt, XML_ERR_DOCUMENT_EMPTY,
@@ -10925,6 +12103,8 @@ xmlParseTryOrFinish(xmlParserCtxtPtr ctxt, int terminate) {
 		}
 		if ((!terminate) && (!xmlParseLookupGt(ctxt)))
                     goto done;
+                if (PARSER_INTERRUPTED(ctxt))
+                    goto done;
 		if (ctxt->spaceNr == 0)
 		    spacePush(ctxt, -1);
 		else if (*ctxt->space == -2)
@@ -10968,6 +12148,11 @@ xmlParseTryOrFinish(xmlParserCtxtPtr ctxt, int terminate) {
 			    (!ctxt->disableSAX))
 			    ctxt->sax->endElementNs(ctxt->userData, name,
 			                            prefix, URI);
+#ifdef LIBXML_SCHEMAS_ENABLED
+			if ((ctxt->schemaValid != NULL) && (!ctxt->disableSAX))
+			    xmlSchemaValidateEndTag(ctxt->schemaValid, name,
+			                            URI);
+#endif
 			if (nbNs > 0)
 			    xmlParserNsPop(ctxt, nbNs);
 #ifdef LIBXML_SAX1_ENABLED
@@ -11205,73 +12390,194 @@ done:
     return(ret);
 }
 
+/*
+ * Maximum number of bytes copied from a borrowed chunk to complete
+ * data left over from the previous chunk.
+ */
+#define XML_BORROW_PREFIX 4096
+
 /**
- * Parse a chunk of memory in push parser mode.
- *
- * Assumes that the parser context was initialized with
- * #xmlCreatePushParserCtxt.
- *
- * The last chunk, which will often be empty, must be marked with
- * the `terminate` flag. With the default SAX callbacks, the resulting
- * document will be available in ctxt->myDoc. This pointer will not
- * be freed when calling #xmlFreeParserCtxt and must be freed by the
- * caller. If the document isn't well-formed, it will still be returned
- * in ctxt->myDoc.
- *
- * As an exception, #xmlCtxtResetPush will free the document in
- * ctxt->myDoc. So ctxt->myDoc should be set to NULL after extracting
- * the document.
- *
- * Since 2.14.0, #xmlCtxtGetDocument can be used to retrieve the
- * result document.
+ * Push a copy of a chunk to the internal input buffer.
  *
  * @param ctxt  an XML parser context
  * @param chunk  chunk of memory
  * @param size  size of chunk in bytes
- * @param terminate  last chunk indicator
- * @returns an xmlParserErrors code (0 on success).
+ * @returns 0 on success, -1 on error.
  */
-int
-xmlParseChunk(xmlParserCtxt *ctxt, const char *chunk, int size,
-              int terminate) {
-    size_t curBase;
-    size_t maxLength;
+static int
+xmlParsePushCopy(xmlParserCtxtPtr ctxt, const char *chunk, int size) {
     size_t pos;
-    int end_in_lf = 0;
     int res;
 
-    if ((ctxt == NULL) || (size < 0))
-        return(XML_ERR_ARGUMENT);
-    if ((chunk == NULL) && (size > 0))
-        return(XML_ERR_ARGUMENT);
-    if ((ctxt->input == NULL) || (ctxt->input->buf == NULL))
-        return(XML_ERR_ARGUMENT);
-    if (ctxt->disableSAX != 0)
-        return(ctxt->errNo);
+    /*
+     * Release parsed input first. Otherwise, growing the buffer
+     * moves the previous chunk along with the unparsed data.
+     */
+    xmlParserShrink(ctxt);
 
-    ctxt->input->flags |= XML_INPUT_PROGRESSIVE;
-    if (ctxt->instate == XML_PARSER_START)
-        xmlCtxtInitializeLate(ctxt);
-    if ((size > 0) && (chunk != NULL) && (!terminate) &&
-        (chunk[size - 1] == '\r')) {
-	end_in_lf = 1;
-	size--;
-    }
-
-    /*
-     * Also push an empty chunk to make sure that the raw buffer
-     * will be flushed if there is an encoder.
-     */
     pos = ctxt->input->cur - ctxt->input->base;
     res = xmlParserInputBufferPush(ctxt->input->buf, size, chunk);
     xmlBufUpdateInput(ctxt->input->buf->buffer, ctxt->input, pos);
+    ctxt->stats.inputGrows++;
     if (res < 0) {
         xmlCtxtErrIO(ctxt, ctxt->input->buf->error, NULL);
-        return(ctxt->errNo);
+        return(-1);
+    }
+
+    return(0);
+}
+
+/**
+ * Check whether a chunk can be parsed in place.
+ *
+ * @param ctxt  an XML parser context
+ * @param chunk  chunk of memory
+ * @param size  size of chunk in bytes
+ * @returns 1 if the chunk can be borrowed, 0 otherwise.
+ */
+static int
+xmlParseCanBorrow(xmlParserCtxtPtr ctxt, const char *chunk, int size) {
+    xmlParserInputPtr in = ctxt->input;
+
+    if ((size <= 0) || (chunk[size] != 0))
+        return(0);
+    if ((ctxt->instate == XML_PARSER_START) ||
+        (ctxt->instate == XML_PARSER_EOF) ||
+        (ctxt->disableSAX != 0) ||
+        (ctxt->inputNr != 1))
+        return(0);
+    if ((in->buf->encoder != NULL) || (in->buf->error != 0) ||
+        (in->flags & XML_INPUT_KEEP_SOURCE))
+        return(0);
+
+    return(1);
+}
+
+/**
+ * Parse a chunk in place. The chunk temporarily replaces the internal
+ * input buffer. Data left over from the previous chunk is completed
+ * with a copy of the start of the chunk. Once the copy is parsed up to
+ * the start of the chunk, the parser switches to the chunk itself.
+ * Input which remains unparsed is copied back to the internal buffer
+ * before returning.
+ *
+ * @param ctxt  an XML parser context
+ * @param chunk  zero-terminated chunk of memory
+ * @param size  size of chunk in bytes
+ * @param terminate  last chunk indicator
+ * @returns 0 on success, -1 on error.
+ */
+static int
+xmlParseChunkBorrow(xmlParserCtxtPtr ctxt, const char *chunk, int size,
+                    int terminate) {
+    xmlParserInputPtr in = ctxt->input;
+    xmlBufPtr own = in->buf->buffer;
+    xmlBufPtr borrowed;
+    size_t pending = in->end - in->cur;
+    size_t start = 0;
+    size_t used;
+    int res;
+
+    if (pending > 0) {
+        size_t prefix = size < XML_BORROW_PREFIX ? size : XML_BORROW_PREFIX;
+
+        if (xmlParsePushCopy(ctxt, chunk, prefix) < 0)
+            return(-1);
+        xmlParseTryOrFinish(ctxt, terminate && (prefix == (size_t) size));
+        if (prefix == (size_t) size)
+            return(0);
+
+        /*
+         * Keep copying if the leftover data still extends into the
+         * previous chunk.
+         */
+        pending = in->end - in->cur;
+        if ((pending > prefix) || (!xmlParseCanBorrow(ctxt, chunk, size))) {
+            if (xmlParsePushCopy(ctxt, chunk + prefix, size - prefix) < 0)
+                return(-1);
+            xmlParseTryOrFinish(ctxt, terminate);
+            return(0);
+        }
+
+        start = prefix - pending;
     }
 
+    borrowed = xmlBufCreateMem((const xmlChar *) chunk + start,
+                               size - start, 1);
+    if (borrowed == NULL) {
+        xmlCtxtErrMemory(ctxt);
+        return(-1);
+    }
+
+    /* The leftover data is available from the chunk now */
+    xmlParserInputSyncLines(in);
+    xmlSaturatedAddSizeT(&in->consumed, in->cur - in->base);
+    xmlBufEmpty(own);
+
+    in->buf->buffer = borrowed;
+    xmlBufUpdateInput(borrowed, in, 0);
+
     xmlParseTryOrFinish(ctxt, terminate);
 
+    xmlParserInputSyncLines(in);
+    used = in->cur - in->base;
+    res = xmlBufAdd(own, in->cur, in->end - in->cur);
+    xmlSaturatedAddSizeT(&in->consumed, used);
+
+    in->buf->buffer = own;
+    xmlBufUpdateInput(own, in, 0);
+    xmlBufFree(borrowed);
+
+    if (res != 0) {
+        in->buf->error = XML_ERR_NO_MEMORY;
+        xmlCtxtErrMemory(ctxt);
+        return(-1);
+    }
+
+    return(0);
+}
+
+static int
+xmlParseChunkInternal(xmlParserCtxt *ctxt, const char *chunk, int size,
+                      int terminate, int borrow) {
+    size_t curBase;
+    size_t maxLength;
+    size_t pos;
+    int end_in_lf = 0;
+    int res;
+
+    if ((ctxt == NULL) || (size < 0))
+        return(XML_ERR_ARGUMENT);
+    if ((chunk == NULL) && (size > 0))
+        return(XML_ERR_ARGUMENT);
+    if ((ctxt->input == NULL) || (ctxt->input->buf == NULL))
+        return(XML_ERR_ARGUMENT);
+    if (ctxt->disableSAX != 0)
+        return(ctxt->errNo);
+
+    ctxt->input->flags |= XML_INPUT_PROGRESSIVE;
+    if (ctxt->instate == XML_PARSER_START)
+        xmlCtxtInitializeLate(ctxt);
+    if ((size > 0) && (chunk != NULL) && (!terminate) &&
+        (chunk[size - 1] == '\r')) {
+	end_in_lf = 1;
+	size--;
+    }
+
+    if ((borrow) && (!end_in_lf) && (xmlParseCanBorrow(ctxt, chunk, size))) {
+        if (xmlParseChunkBorrow(ctxt, chunk, size, terminate) < 0)
+            return(ctxt->errNo);
+    } else {
+        /*
+         * Also push an empty chunk to make sure that the raw buffer
+         * will be flushed if there is an encoder.
+         */
+        if (xmlParsePushCopy(ctxt, chunk, size) < 0)
+            return(ctxt->errNo);
+
+        xmlParseTryOrFinish(ctxt, terminate);
+    }
+
     curBase = ctxt->input->cur - ctxt->input->base;
     maxLength = (ctxt->options & XML_PARSE_HUGE) ?
                 XML_MAX_HUGE_LENGTH :
@@ -11294,6 +12600,14 @@ xmlParseChunk(xmlParserCtxt *ctxt, const char *chunk, int size,
         }
     }
     if (terminate) {
+        /*
+         * A stream may end between documents
+         */
+        if ((ctxt->streamDocs > 0) &&
+            (ctxt->instate == XML_PARSER_XML_DECL) &&
+            (ctxt->input->cur >= ctxt->input->end))
+            ctxt->instate = XML_PARSER_EOF;
+
 	/*
 	 * Check for termination
 	 */
@@ -11325,6 +12639,102 @@ xmlParseChunk(xmlParserCtxt *ctxt, const char *chunk, int size,
         return(0);
 }
 
+/**
+ * Parse a chunk of memory in push parser mode.
+ *
+ * Assumes that the parser context was initialized with
+ * #xmlCreatePushParserCtxt.
+ *
+ * The last chunk, which will often be empty, must be marked with
+ * the `terminate` flag. With the default SAX callbacks, the resulting
+ * document will be available in ctxt->myDoc. This pointer will not
+ * be freed when calling #xmlFreeParserCtxt and must be freed by the
+ * caller. If the document isn't well-formed, it will still be returned
+ * in ctxt->myDoc.
+ *
+ * As an exception, #xmlCtxtResetPush will free the document in
+ * ctxt->myDoc. So ctxt->myDoc should be set to NULL after extracting
+ * the document.
+ *
+ * Since 2.14.0, #xmlCtxtGetDocument can be used to retrieve the
+ * result document.
+ *
+ * @param ctxt  an XML parser context
+ * @param chunk  chunk of memory
+ * @param size  size of chunk in bytes
+ * @param terminate  last chunk indicator
+ * @returns an xmlParserErrors code (0 on success).
+ */
+int
+xmlParseChunk(xmlParserCtxt *ctxt, const char *chunk, int size,
+              int terminate) {
+    xmlMemBudget *oldBudget;
+    int res;
+
+    if (ctxt == NULL)
+        return(XML_ERR_ARGUMENT);
+
+    if ((ctxt->instate == XML_PARSER_START) && (ctxt->input != NULL))
+        XML_TRACE_BEGIN(doc, XML_TRACE_DOC_START, ctxt->input->filename,
+                        ctxt->traceStart);
+
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+    res = xmlParseChunkInternal(ctxt, chunk, size, terminate, 0);
+    xmlMemBudgetLeave(oldBudget);
+
+    if ((terminate) && (ctxt->input != NULL))
+        XML_TRACE_END(doc, XML_TRACE_DOC_END, ctxt->input->filename,
+                      xmlCtxtTraceBytes(ctxt), ctxt->traceStart);
+
+    return(res);
+}
+
+/**
+ * Parse a chunk of memory in push parser mode without copying it to
+ * the internal input buffer.
+ *
+ * Works like #xmlParseChunk, but the parser reads directly from
+ * `chunk` while the function runs. Only input which can't be parsed
+ * yet, typically an incomplete construct at the end of the chunk, is
+ * copied. The chunk isn't referenced after the function returns, so
+ * the caller can reuse or release the whole chunk right away.
+ *
+ * The byte at `chunk[size]` must be zero. Chunks which don't meet
+ * this requirement, the first chunk of a document and inputs which
+ * need encoding conversion are copied as with #xmlParseChunk.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param chunk  zero-terminated chunk of memory
+ * @param size  size of chunk in bytes, excluding the terminator
+ * @param terminate  last chunk indicator
+ * @returns an xmlParserErrors code (0 on success).
+ */
+int
+xmlParseChunkBorrowed(xmlParserCtxt *ctxt, const char *chunk, int size,
+                      int terminate) {
+    xmlMemBudget *oldBudget;
+    int res;
+
+    if (ctxt == NULL)
+        return(XML_ERR_ARGUMENT);
+
+    if ((ctxt->instate == XML_PARSER_START) && (ctxt->input != NULL))
+        XML_TRACE_BEGIN(doc, XML_TRACE_DOC_START, ctxt->input->filename,
+                        ctxt->traceStart);
+
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+    res = xmlParseChunkInternal(ctxt, chunk, size, terminate, 1);
+    xmlMemBudgetLeave(oldBudget);
+
+    if ((terminate) && (ctxt->input != NULL))
+        XML_TRACE_END(doc, XML_TRACE_DOC_END, ctxt->input->filename,
+                      xmlCtxtTraceBytes(ctxt), ctxt->traceStart);
+
+    return(res);
+}
+
 /************************************************************************
  *									*
  *		I/O front end functions to the parser			*
@@ -11383,6 +12793,10 @@ xmlCreatePushParserCtxt(xmlSAXHandler *sax, void *user_data,
 /**
  * Blocks further parser processing
  *
+ * This function can also be called from another thread to cancel a
+ * parse run. The parser then stops at the next element boundary or
+ * read from the input.
+ *
  * @param ctxt  an XML parser context
  */
 void
@@ -11390,6 +12804,8 @@ xmlStopParser(xmlParserCtxt *ctxt) {
     if (ctxt == NULL)
         return;
 
+    /* Sticky request, which the parser can't reset by accident */
+    ctxt->stopRequested = 1;
     /* This stops the parser */
     ctxt->disableSAX = 2;
 
@@ -11659,89 +13075,444 @@ xmlParseDTD(const xmlChar *publicId, const xmlChar *systemId) {
 
 /************************************************************************
  *									*
- *		Front ends when parsing an Entity			*
+ *		Shared DTDs						*
  *									*
  ************************************************************************/
 
-static xmlNodePtr
-xmlCtxtParseContentInternal(xmlParserCtxtPtr ctxt, xmlParserInputPtr input,
-                            int hasTextDecl, int buildTree) {
-    xmlNodePtr root = NULL;
-    xmlNodePtr list = NULL;
-    xmlChar *rootName = BAD_CAST "#root";
-    int result;
-
-    if (buildTree) {
-        root = xmlNewDocNode(ctxt->myDoc, NULL, rootName, NULL);
-        if (root == NULL) {
-            xmlErrMemory(ctxt);
-            goto error;
-        }
-    }
-
-    if (xmlCtxtPushInput(ctxt, input) < 0)
-        goto error;
+/*
+ * Process-wide registry of immutable DTDs which are used as external
+ * subset of documents without being parsed or copied again. Each DTD
+ * is owned by an internal document and reference counted. The
+ * registry holds one reference per key, every document using the DTD
+ * holds another one.
+ */
+typedef struct _xmlSharedDtd xmlSharedDtd;
+struct _xmlSharedDtd {
+    xmlDocPtr doc;
+    int refs;
+};
 
-    nameNsPush(ctxt, rootName, NULL, NULL, 0, 0);
-    spacePush(ctxt, -1);
+static xmlMutex xmlDtdCacheMutex;
+static xmlHashTablePtr xmlDtdCacheHash;
 
-    if (buildTree)
-        nodePush(ctxt, root);
+/*
+ * Secondary keys to distinguish public and system IDs.
+ */
+static const xmlChar xmlDtdCachePublic[] = "public";
+static const xmlChar xmlDtdCacheSystem[] = "system";
 
-    if (hasTextDecl) {
-        xmlDetectEncoding(ctxt);
+/**
+ * Initialize the shared DTD registry.
+ */
+void
+xmlInitDtdCacheInternal(void) {
+    xmlInitMutex(&xmlDtdCacheMutex);
+}
 
-        /*
-         * Parse a possible text declaration first
-         */
-        if ((CMP5(CUR_PTR, '<', '?', 'x', 'm', 'l')) &&
-            (IS_BLANK_CH(NXT(5)))) {
-            xmlParseTextDecl(ctxt);
-            /*
-             * An XML-1.0 document can't reference an entity not XML-1.0
-             */
-            if ((xmlStrEqual(ctxt->version, BAD_CAST "1.0")) &&
-                (!xmlStrEqual(ctxt->input->version, BAD_CAST "1.0"))) {
-                xmlFatalErrMsg(ctxt, XML_ERR_VERSION_MISMATCH,
-                               "Version mismatch between document and "
-                               "entity\n");
-            }
-        }
+/**
+ * Drop a reference to a shared DTD. The mutex must be held.
+ *
+ * @param entry  the shared DTD
+ */
+static void
+xmlDtdCacheUnref(xmlSharedDtd *entry) {
+    entry->refs -= 1;
+    if (entry->refs <= 0) {
+        xmlFreeDoc(entry->doc);
+        xmlFree(entry);
     }
+}
 
-    xmlParseContentInternal(ctxt);
+static void
+xmlDtdCacheDeallocator(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlDtdCacheUnref(payload);
+}
 
-    if (ctxt->input->cur < ctxt->input->end)
-	xmlFatalErr(ctxt, XML_ERR_NOT_WELL_BALANCED, NULL);
+/**
+ * Free the shared DTD registry.
+ */
+void
+xmlCleanupDtdCacheInternal(void) {
+    xmlHashFree(xmlDtdCacheHash, xmlDtdCacheDeallocator);
+    xmlDtdCacheHash = NULL;
+    xmlCleanupMutex(&xmlDtdCacheMutex);
+}
 
-    if ((ctxt->wellFormed) ||
-        ((ctxt->recovery) && (!xmlCtxtIsCatastrophicError(ctxt)))) {
-        if (root != NULL) {
-            xmlNodePtr cur;
+static void
+xmlDtdCacheParseEntity(void *payload, void *data,
+                       const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlEntityPtr ent = payload;
+    xmlParserCtxtPtr ctxt = data;
+
+    if (((ent->etype == XML_INTERNAL_GENERAL_ENTITY) ||
+         (ent->etype == XML_EXTERNAL_GENERAL_PARSED_ENTITY)) &&
+        ((ent->flags & XML_ENT_PARSED) == 0))
+        xmlCtxtParseEntity(ctxt, ent);
+}
 
-            /*
-             * Unlink newly created node list.
-             */
-            list = root->children;
-            root->children = NULL;
-            root->last = NULL;
-            for (cur = list; cur != NULL; cur = cur->next)
-                cur->parent = NULL;
-        }
-    }
+static void
+xmlDtdCacheMarkEntity(void *payload, void *data ATTRIBUTE_UNUSED,
+                      const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlEntityPtr ent = payload;
 
-    /*
-     * Read the rest of the stream in case of errors. We want
-     * to account for the whole entity size.
-     */
-    do {
-        ctxt->input->cur = ctxt->input->end;
-        xmlParserShrink(ctxt);
-        result = xmlParserGrow(ctxt);
-    } while (result > 0);
+    ent->flags |= XML_ENT_SHARED;
+}
 
-    if (buildTree)
-        nodePop(ctxt);
+#ifdef LIBXML_REGEXP_ENABLED
+static void
+xmlDtdCacheBuildModel(void *payload, void *data,
+                      const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlValidBuildContentModel(data, payload);
+}
+#endif
+
+/**
+ * Register a DTD as shared external subset.
+ *
+ * Documents parsed with XML_PARSE_DTDLOAD or XML_PARSE_DTDVALID
+ * whose document type declaration has the public ID `publicId` or,
+ * if no DTD is registered for their public ID, the system ID
+ * `systemId` use the registered DTD as external subset instead of
+ * loading and parsing it. The system ID is compared literally as it
+ * appears in the document type declaration. The DTD is shared between
+ * all these documents and threads without copying it.
+ *
+ * Before registration, the content models of all element declarations
+ * are compiled and all general parsed entities, including external
+ * ones, are parsed, so that the DTD is never modified afterwards.
+ * Registering a DTD under an ID which is already in use replaces the
+ * older DTD for documents parsed later.
+ *
+ * The DTD must not be part of a document, typically it was returned
+ * from #xmlCtxtParseDtd or #xmlParseDTD. Unless it is rejected for
+ * this reason or missing IDs, the registry takes ownership of the
+ * DTD, even in case of an error. It must not be modified or freed
+ * afterwards. Documents using a shared DTD must be freed before
+ * calling #xmlCleanupParser.
+ *
+ * The shared DTD isn't used if the external subset is loaded with a
+ * custom SAX handler or if XML_PARSE_NO_XXE is set.
+ *
+ * This function is thread-safe.
+ *
+ * @since 2.16.0
+ *
+ * @param dtd  the DTD
+ * @param publicId  public ID (optional)
+ * @param systemId  system ID (optional)
+ * @returns 0 on success or -1 in case of error.
+ */
+int
+xmlDtdCacheAdd(xmlDtd *dtd, const xmlChar *publicId,
+               const xmlChar *systemId) {
+    xmlParserCtxtPtr ctxt = NULL;
+    xmlSharedDtd *entry;
+    xmlDocPtr doc;
+    xmlNodePtr cur, root;
+    int keep = 0;
+    int ret = -1;
+
+    if ((dtd == NULL) || (dtd->doc != NULL) || (dtd->parent != NULL) ||
+        ((publicId == NULL) && (systemId == NULL)))
+        return(-1);
+
+    xmlInitParser();
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    if (doc == NULL) {
+        xmlFreeDtd(dtd);
+        return(-1);
+    }
+    doc->properties = XML_DOC_INTERNAL | XML_DOC_SHARED_DTD;
+    doc->extSubset = dtd;
+    dtd->doc = doc;
+    for (cur = dtd->children; cur != NULL; cur = cur->next)
+        cur->doc = doc;
+
+    entry = xmlMalloc(sizeof(*entry));
+    if (entry == NULL)
+        goto error;
+    entry->doc = doc;
+    entry->refs = 0;
+    doc->_private = entry;
+
+    ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL)
+        goto error;
+    xmlCtxtSetOptions(ctxt, XML_PARSE_NOENT);
+    doc->dict = ctxt->dict;
+    xmlDictReference(doc->dict);
+    ctxt->myDoc = doc;
+
+    /*
+     * Parse entity content below a dummy element to build the
+     * trees which are copied into documents.
+     */
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "root", NULL);
+    if (root == NULL) {
+        xmlErrMemory(ctxt);
+        goto error;
+    }
+    if (nodePush(ctxt, root) == 0) {
+        if (dtd->entities != NULL)
+            xmlHashScan(dtd->entities, xmlDtdCacheParseEntity, ctxt);
+        nodePop(ctxt);
+    }
+    xmlFreeNode(root);
+
+#ifdef LIBXML_REGEXP_ENABLED
+    if (dtd->elements != NULL)
+        xmlHashScan(dtd->elements, xmlDtdCacheBuildModel, &ctxt->vctxt);
+#endif
+
+    if ((!ctxt->wellFormed) || (xmlCtxtIsCatastrophicError(ctxt)))
+        goto error;
+
+    if (dtd->entities != NULL)
+        xmlHashScan(dtd->entities, xmlDtdCacheMarkEntity, NULL);
+    if (dtd->pentities != NULL)
+        xmlHashScan(dtd->pentities, xmlDtdCacheMarkEntity, NULL);
+
+    xmlMutexLock(&xmlDtdCacheMutex);
+
+    if (xmlDtdCacheHash == NULL)
+        xmlDtdCacheHash = xmlHashCreate(0);
+    if (xmlDtdCacheHash != NULL) {
+        ret = 0;
+
+        if (publicId != NULL) {
+            entry->refs += 1;
+            if (xmlHashUpdateEntry2(xmlDtdCacheHash, publicId,
+                                    xmlDtdCachePublic, entry,
+                                    xmlDtdCacheDeallocator) < 0) {
+                entry->refs -= 1;
+                ret = -1;
+            }
+        }
+        if ((systemId != NULL) && (ret == 0)) {
+            entry->refs += 1;
+            if (xmlHashUpdateEntry2(xmlDtdCacheHash, systemId,
+                                    xmlDtdCacheSystem, entry,
+                                    xmlDtdCacheDeallocator) < 0) {
+                entry->refs -= 1;
+                ret = -1;
+            }
+        }
+    }
+
+    /* Keys registered before an error keep the DTD alive */
+    keep = (entry->refs > 0);
+
+    xmlMutexUnlock(&xmlDtdCacheMutex);
+
+error:
+    if (ctxt != NULL) {
+        ctxt->myDoc = NULL;
+        xmlFreeParserCtxt(ctxt);
+    }
+    if (!keep) {
+        xmlFreeDoc(doc);
+        xmlFree(entry);
+    }
+    return(ret);
+}
+
+/**
+ * Remove all DTDs from the shared DTD registry. DTDs which are still
+ * used by documents are freed together with the last document.
+ *
+ * This function is thread-safe.
+ *
+ * @since 2.16.0
+ */
+void
+xmlDtdCacheClear(void) {
+    xmlInitParser();
+
+    xmlMutexLock(&xmlDtdCacheMutex);
+    xmlHashFree(xmlDtdCacheHash, xmlDtdCacheDeallocator);
+    xmlDtdCacheHash = NULL;
+    xmlMutexUnlock(&xmlDtdCacheMutex);
+}
+
+static void
+xmlDtdCacheAddAttr(void *payload, void *data,
+                   const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlAttributePtr attr = payload;
+    xmlParserCtxtPtr ctxt = data;
+    const xmlChar *fullattr = attr->name;
+    xmlChar *tmp = NULL;
+
+    if (attr->prefix != NULL) {
+        tmp = xmlBuildQName(attr->name, attr->prefix, NULL, 0);
+        if (tmp == NULL) {
+            xmlErrMemory(ctxt);
+            return;
+        }
+        fullattr = tmp;
+    }
+
+    if ((attr->defaultValue != NULL) &&
+        (attr->def != XML_ATTRIBUTE_IMPLIED) &&
+        (attr->def != XML_ATTRIBUTE_REQUIRED))
+        xmlAddDefAttrs(ctxt, attr->elem, fullattr, attr->defaultValue);
+    xmlAddSpecialAttr(ctxt, attr->elem, fullattr,
+                      attr->atype | XML_SPECIAL_EXTERNAL);
+
+    xmlFree(tmp);
+}
+
+/**
+ * Look up a shared DTD for the external subset of the document being
+ * parsed. On success, a reference to the DTD is taken and the
+ * defaulted and special attributes of the parser context are set up
+ * as if the DTD had been parsed.
+ *
+ * @param ctxt  parser context
+ * @param publicId  public ID of the external subset (optional)
+ * @param systemId  system ID of the external subset (optional)
+ * @returns the shared DTD or NULL if none is registered.
+ */
+xmlDtdPtr
+xmlDtdCacheLookup(xmlParserCtxtPtr ctxt, const xmlChar *publicId,
+                  const xmlChar *systemId) {
+    xmlSharedDtd *entry = NULL;
+    xmlDtdPtr dtd;
+
+    xmlMutexLock(&xmlDtdCacheMutex);
+
+    if (xmlDtdCacheHash != NULL) {
+        if (publicId != NULL)
+            entry = xmlHashLookup2(xmlDtdCacheHash, publicId,
+                                   xmlDtdCachePublic);
+        if ((entry == NULL) && (systemId != NULL))
+            entry = xmlHashLookup2(xmlDtdCacheHash, systemId,
+                                   xmlDtdCacheSystem);
+        if (entry != NULL)
+            entry->refs += 1;
+    }
+
+    xmlMutexUnlock(&xmlDtdCacheMutex);
+
+    if (entry == NULL)
+        return(NULL);
+
+    dtd = entry->doc->extSubset;
+    if ((ctxt->sax2) && (dtd->attributes != NULL))
+        xmlHashScan(dtd->attributes, xmlDtdCacheAddAttr, ctxt);
+
+    return(dtd);
+}
+
+/**
+ * Release the external subset of a document if it's a shared DTD.
+ * doc->extSubset is reset in this case.
+ *
+ * @param doc  the document
+ */
+void
+xmlDtdCacheRelease(xmlDocPtr doc) {
+    xmlDtdPtr dtd = doc->extSubset;
+
+    if ((dtd == NULL) || (dtd->doc == NULL) || (dtd->doc == doc) ||
+        ((dtd->doc->properties & XML_DOC_SHARED_DTD) == 0))
+        return;
+
+    doc->extSubset = NULL;
+
+    xmlMutexLock(&xmlDtdCacheMutex);
+    xmlDtdCacheUnref(dtd->doc->_private);
+    xmlMutexUnlock(&xmlDtdCacheMutex);
+}
+
+/************************************************************************
+ *									*
+ *		Front ends when parsing an Entity			*
+ *									*
+ ************************************************************************/
+
+static xmlNodePtr
+xmlCtxtParseContentInternal(xmlParserCtxtPtr ctxt, xmlParserInputPtr input,
+                            int hasTextDecl, int buildTree) {
+    xmlNodePtr root = NULL;
+    xmlNodePtr list = NULL;
+    xmlChar *rootName = BAD_CAST "#root";
+    xmlMemBudget *oldBudget;
+    int result;
+
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+
+    if (buildTree) {
+        root = xmlNewDocNode(ctxt->myDoc, NULL, rootName, NULL);
+        if (root == NULL) {
+            xmlErrMemory(ctxt);
+            goto error;
+        }
+    }
+
+    if (xmlCtxtPushInput(ctxt, input) < 0)
+        goto error;
+
+    nameNsPush(ctxt, rootName, NULL, NULL, 0, 0);
+    spacePush(ctxt, -1);
+
+    if (buildTree)
+        nodePush(ctxt, root);
+
+    if (hasTextDecl) {
+        xmlDetectEncoding(ctxt);
+
+        /*
+         * Parse a possible text declaration first
+         */
+        if ((CMP5(CUR_PTR, '<', '?', 'x', 'm', 'l')) &&
+            (IS_BLANK_CH(NXT(5)))) {
+            xmlParseTextDecl(ctxt);
+            /*
+             * An XML-1.0 document can't reference an entity not XML-1.0
+             */
+            if ((xmlStrEqual(ctxt->version, BAD_CAST "1.0")) &&
+                (!xmlStrEqual(ctxt->input->version, BAD_CAST "1.0"))) {
+                xmlFatalErrMsg(ctxt, XML_ERR_VERSION_MISMATCH,
+                               "Version mismatch between document and "
+                               "entity\n");
+            }
+        }
+    }
+
+    xmlParseContentInternal(ctxt);
+
+    if (ctxt->input->cur < ctxt->input->end)
+	xmlFatalErr(ctxt, XML_ERR_NOT_WELL_BALANCED, NULL);
+
+    if ((ctxt->wellFormed) ||
+        ((ctxt->recovery) && (!xmlCtxtIsCatastrophicError(ctxt)))) {
+        if (root != NULL) {
+            xmlNodePtr cur;
+
+            /*
+             * Unlink newly created node list.
+             */
+            list = root->children;
+            root->children = NULL;
+            root->last = NULL;
+            for (cur = list; cur != NULL; cur = cur->next)
+                cur->parent = NULL;
+        }
+    }
+
+    /*
+     * Read the rest of the stream in case of errors. We want
+     * to account for the whole entity size.
+     */
+    do {
+        ctxt->input->cur = ctxt->input->end;
+        xmlParserShrink(ctxt);
+        result = xmlParserGrow(ctxt);
+    } while (result > 0);
+
+    if (buildTree)
+        nodePop(ctxt);
 
     namePop(ctxt);
     spacePop(ctxt);
@@ -11750,6 +13521,7 @@ xmlCtxtParseContentInternal(xmlParserCtxtPtr ctxt, xmlParserInputPtr input,
 
 error:
     xmlFreeNode(root);
+    xmlMemBudgetLeave(oldBudget);
 
     return(list);
 }
@@ -11763,6 +13535,8 @@ xmlCtxtParseEntity(xmlParserCtxtPtr ctxt, xmlEntityPtr ent) {
     int buildTree;
     int oldMinNsIndex;
     int oldNodelen, oldNodemem;
+    int oldFilterDepth;
+    xmlTextSinkFunc oldTextSink;
 
     isExternal = (ent->etype == XML_EXTERNAL_GENERAL_PARSED_ENTITY);
     buildTree = (ctxt->node != NULL);
@@ -11795,6 +13569,12 @@ xmlCtxtParseEntity(xmlParserCtxtPtr ctxt, xmlEntityPtr ent) {
     oldNodemem = ctxt->nodemem;
     ctxt->nodelen = 0;
     ctxt->nodemem = 0;
+    /* Entity content is copied, keep it in the tree */
+    oldTextSink = ctxt->textSink;
+    ctxt->textSink = NULL;
+    oldFilterDepth = ctxt->filterDepth;
+    if (ctxt->filterStreams != NULL)
+        ctxt->filterDepth = 1;
 
     /*
      * Parse content
@@ -11822,6 +13602,8 @@ xmlCtxtParseEntity(xmlParserCtxtPtr ctxt, xmlEntityPtr ent) {
     ctxt->nsdb->minNsIndex = oldMinNsIndex;
     ctxt->nodelen = oldNodelen;
     ctxt->nodemem = oldNodemem;
+    ctxt->textSink = oldTextSink;
+    ctxt->filterDepth = oldFilterDepth;
 
     /*
      * Entity size accounting
@@ -12989,23 +14771,18 @@ xmlParseDoc(const xmlChar *cur) {
  ************************************************************************/
 
 /**
- * Reset a parser context
+ * Reset the state of a parser context which only applies to a
+ * single document. Inputs and settings are kept.
  *
  * @param ctxt  an XML parser context
  */
-void
-xmlCtxtReset(xmlParserCtxt *ctxt)
+static void
+xmlCtxtResetDocument(xmlParserCtxtPtr ctxt)
 {
-    xmlParserInputPtr input;
-
-    if (ctxt == NULL)
-        return;
-
-    while ((input = xmlCtxtPopInput(ctxt)) != NULL) { /* Non consuming */
-        xmlFreeInputStream(input);
-    }
-    ctxt->inputNr = 0;
-    ctxt->input = NULL;
+    xmlMemBudgetReset(ctxt->memBudget);
+    if (ctxt->timeLimit != 0)
+        ctxt->deadline = xmlMonotonicTimeMs() + ctxt->timeLimit;
+    ctxt->interruptChecks = 0;
 
     ctxt->spaceNr = 0;
     if (ctxt->spaceTab != NULL) {
@@ -13018,12 +14795,15 @@ xmlCtxtReset(xmlParserCtxt *ctxt)
 
     ctxt->nodeNr = 0;
     ctxt->node = NULL;
+    ctxt->textSinkNode = NULL;
+    ctxt->partialText = 0;
 
     ctxt->nameNr = 0;
     ctxt->name = NULL;
 
     ctxt->nsNr = 0;
     xmlParserNsReset(ctxt->nsdb);
+    xmlCtxtFreeSourceSpans(ctxt);
 
     if (ctxt->version != NULL) {
         xmlFree(ctxt->version);
@@ -13041,34 +14821,21 @@ xmlCtxtReset(xmlParserCtxt *ctxt)
         xmlFree(ctxt->extSubSystem);
         ctxt->extSubSystem = NULL;
     }
-    if (ctxt->directory != NULL) {
-        xmlFree(ctxt->directory);
-        ctxt->directory = NULL;
-    }
-
-    if (ctxt->myDoc != NULL)
-        xmlFreeDoc(ctxt->myDoc);
-    ctxt->myDoc = NULL;
-
     ctxt->standalone = -1;
     ctxt->hasExternalSubset = 0;
     ctxt->hasPErefs = 0;
-    ctxt->html = ctxt->html ? 1 : 0;
-    ctxt->instate = XML_PARSER_START;
 
     ctxt->wellFormed = 1;
     ctxt->nsWellFormed = 1;
-    ctxt->disableSAX = 0;
     ctxt->valid = 1;
-    ctxt->record_info = 0;
     ctxt->checkIndex = 0;
     ctxt->endCheckState = 0;
     ctxt->inSubset = 0;
     ctxt->errNo = XML_ERR_OK;
     ctxt->depth = 0;
-    ctxt->catalogs = NULL;
     ctxt->sizeentities = 0;
     ctxt->sizeentcopy = 0;
+    xmlCtxtResetStats(ctxt);
     xmlInitNodeInfoSeq(&ctxt->node_seq);
 
     if (ctxt->attsDefault != NULL) {
@@ -13079,17 +14846,63 @@ xmlCtxtReset(xmlParserCtxt *ctxt)
         xmlHashFree(ctxt->attsSpecial, NULL);
         ctxt->attsSpecial = NULL;
     }
+    xmlCtxtFreeAttrPlans(ctxt);
+    xmlCtxtFreeEntityTemplates(ctxt);
 
 #ifdef LIBXML_CATALOG_ENABLED
     if (ctxt->catalogs != NULL)
 	xmlCatalogFreeLocal(ctxt->catalogs);
 #endif
+    ctxt->catalogs = NULL;
     ctxt->nbErrors = 0;
     ctxt->nbWarnings = 0;
+    if (ctxt->errorRing != NULL)
+        ((xmlErrorRing *) ctxt->errorRing)->count = 0;
+    xmlErrorPolicyReset(ctxt->errorPolicy);
     if (ctxt->lastError.code != XML_ERR_OK)
         xmlResetError(&ctxt->lastError);
 }
 
+/**
+ * Reset a parser context
+ *
+ * @param ctxt  an XML parser context
+ */
+void
+xmlCtxtReset(xmlParserCtxt *ctxt)
+{
+    xmlParserInputPtr input;
+
+    if (ctxt == NULL)
+        return;
+
+    while ((input = xmlCtxtPopInput(ctxt)) != NULL) { /* Non consuming */
+        xmlFreeInputStream(input);
+    }
+    ctxt->inputNr = 0;
+    ctxt->input = NULL;
+
+    ctxt->stopRequested = 0;
+
+    if (ctxt->directory != NULL) {
+        xmlFree(ctxt->directory);
+        ctxt->directory = NULL;
+    }
+
+    if (ctxt->myDoc != NULL)
+        xmlFreeDoc(ctxt->myDoc);
+    ctxt->myDoc = NULL;
+
+    ctxt->html = ctxt->html ? 1 : 0;
+    ctxt->instate = XML_PARSER_START;
+    ctxt->disableSAX = 0;
+    ctxt->record_info = 0;
+    ctxt->streamDocs = 0;
+
+    xmlCtxtResetDocument(ctxt);
+}
+
+
 /**
  * Reset a push parser context
  *
@@ -13166,7 +14979,10 @@ xmlCtxtSetOptionsInternal(xmlParserCtxtPtr ctxt, int options, int keepMask)
               XML_PARSE_NO_XXE |
               XML_PARSE_UNZIP |
               XML_PARSE_NO_SYS_CATALOG |
-              XML_PARSE_CATALOG_PI;
+              XML_PARSE_CATALOG_PI |
+              XML_PARSE_MMAP |
+              XML_PARSE_ARENA |
+              XML_PARSE_ASYNC_IO;
 
     ctxt->options = (ctxt->options & keepMask) | (options & allMask);
 
@@ -13194,121 +15010,1449 @@ xmlCtxtSetOptionsInternal(xmlParserCtxtPtr ctxt, int options, int keepMask)
     ctxt->keepBlanks = (options & XML_PARSE_NOBLANKS) ? 0 : 1;
     ctxt->dictNames = (options & XML_PARSE_NODICT) ? 0 : 1;
 
-    return(options & ~allMask);
+    return(options & ~allMask);
+}
+
+/**
+ * Applies the options to the parser context. Unset options are
+ * cleared.
+ *
+ * @since 2.13.0
+ *
+ * With older versions, you can use #xmlCtxtUseOptions.
+ *
+ * @param ctxt  an XML parser context
+ * @param options  a bitmask of xmlParserOption values
+ * @returns 0 in case of success, the set of unknown or unimplemented options
+ *         in case of error.
+ */
+int
+xmlCtxtSetOptions(xmlParserCtxt *ctxt, int options)
+{
+#ifdef LIBXML_HTML_ENABLED
+    if ((ctxt != NULL) && (ctxt->html))
+        return(htmlCtxtSetOptions(ctxt, options));
+#endif
+
+    return(xmlCtxtSetOptionsInternal(ctxt, options, 0));
+}
+
+/**
+ * Get the current options of the parser context.
+ *
+ * @since 2.14.0
+ *
+ * @param ctxt  an XML parser context
+ * @returns the current options set in the parser context, or -1 if ctxt is NULL.
+ */
+int
+xmlCtxtGetOptions(xmlParserCtxt *ctxt)
+{
+    if (ctxt == NULL)
+        return(-1);
+
+    return(ctxt->options);
+}
+
+/**
+ * Applies the options to the parser context. The following options
+ * are never cleared and can only be enabled:
+ *
+ * - XML_PARSE_NOERROR
+ * - XML_PARSE_NOWARNING
+ * - XML_PARSE_NONET
+ * - XML_PARSE_NSCLEAN
+ * - XML_PARSE_NOCDATA
+ * - XML_PARSE_COMPACT
+ * - XML_PARSE_OLD10
+ * - XML_PARSE_HUGE
+ * - XML_PARSE_OLDSAX
+ * - XML_PARSE_IGNORE_ENC
+ * - XML_PARSE_BIG_LINES
+ *
+ * @deprecated Use #xmlCtxtSetOptions.
+ *
+ * @param ctxt  an XML parser context
+ * @param options  a combination of xmlParserOption
+ * @returns 0 in case of success, the set of unknown or unimplemented options
+ *         in case of error.
+ */
+int
+xmlCtxtUseOptions(xmlParserCtxt *ctxt, int options)
+{
+    int keepMask;
+
+#ifdef LIBXML_HTML_ENABLED
+    if ((ctxt != NULL) && (ctxt->html))
+        return(htmlCtxtUseOptions(ctxt, options));
+#endif
+
+    /*
+     * For historic reasons, some options can only be enabled.
+     */
+    keepMask = XML_PARSE_NOERROR |
+               XML_PARSE_NOWARNING |
+               XML_PARSE_NONET |
+               XML_PARSE_NSCLEAN |
+               XML_PARSE_NOCDATA |
+               XML_PARSE_COMPACT |
+               XML_PARSE_OLD10 |
+               XML_PARSE_HUGE |
+               XML_PARSE_OLDSAX |
+               XML_PARSE_IGNORE_ENC |
+               XML_PARSE_BIG_LINES;
+
+    return(xmlCtxtSetOptionsInternal(ctxt, options, keepMask));
+}
+
+/**
+ * To protect against exponential entity expansion ("billion laughs"), the
+ * size of serialized output is (roughly) limited to the input size
+ * multiplied by this factor. The default value is 5.
+ *
+ * When working with documents making heavy use of entity expansion, it can
+ * be necessary to increase the value. For security reasons, this should only
+ * be considered when processing trusted input.
+ *
+ * @param ctxt  an XML parser context
+ * @param maxAmpl  maximum amplification factor
+ */
+void
+xmlCtxtSetMaxAmplification(xmlParserCtxt *ctxt, unsigned maxAmpl)
+{
+    if (ctxt == NULL)
+        return;
+    ctxt->maxAmpl = maxAmpl;
+}
+
+/**
+ * Limit the memory a single parse run may hold. Allocations made
+ * while the parser runs are charged to the context. If the budget
+ * is exceeded, parsing stops with an XML_ERR_RESOURCE_LIMIT error.
+ * Other threads and contexts are unaffected.
+ *
+ * Memory is only accounted with an allocator which records block
+ * sizes. Install #xmlPoolMalloc or #xmlMemMalloc and the related
+ * functions with #xmlMemSetup first.
+ *
+ * The accounting is reset by #xmlCtxtReset and the xmlCtxtRead
+ * functions.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param maxMem  maximum number of bytes or 0 for no limit
+ * @returns 0 on success or -1 if budgets aren't supported by the
+ * allocator or a memory allocation failed.
+ */
+int
+xmlCtxtSetMaxMemory(xmlParserCtxt *ctxt, size_t maxMem)
+{
+    if (ctxt == NULL)
+        return(-1);
+    return(xmlMemBudgetSet(&ctxt->memBudget, maxMem));
+}
+
+/**
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @returns the number of bytes charged to the context's memory
+ * budget by the current or last parse run.
+ */
+size_t
+xmlCtxtGetMemoryUsed(xmlParserCtxt *ctxt)
+{
+    if ((ctxt == NULL) || (ctxt->memBudget == NULL))
+        return(0);
+    return(ctxt->memBudget->used);
+}
+
+/**
+ * Limit the wall-clock time of a parse run, measured with a monotonic
+ * clock. The clock is checked periodically at element boundaries and
+ * when reading input. Once the time is up, parsing stops with an
+ * XML_ERR_RESOURCE_LIMIT error.
+ *
+ * The time is measured from this call and restarted by #xmlCtxtReset
+ * and the xmlCtxtRead functions.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param ms  maximum time in milliseconds or 0 for no limit
+ */
+void
+xmlCtxtSetTimeLimit(xmlParserCtxt *ctxt, unsigned long ms)
+{
+    if (ctxt == NULL)
+        return;
+    ctxt->timeLimit = ms;
+    ctxt->deadline = xmlMonotonicTimeMs() + ms;
+    ctxt->interruptChecks = 0;
+}
+
+/**
+ * Defer building the ID table of parsed documents. ID attributes are
+ * only marked while parsing and added to the ID table by the first
+ * call to #xmlGetID or when the document is validated, which saves
+ * time and memory for documents with many IDs which are never looked
+ * up. Duplicate IDs aren't reported in this case.
+ *
+ * Until then, the document's `ids` member doesn't contain these IDs
+ * and the first lookup modifies the document, so it must not run
+ * concurrently with other lookups. IDs are always collected eagerly
+ * when validating and with the xmlReader API.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param lazy  whether to collect IDs lazily
+ */
+void
+xmlCtxtSetLazyIds(xmlParserCtxt *ctxt, int lazy)
+{
+    if (ctxt == NULL)
+        return;
+    ctxt->lazyIds = lazy ? 1 : 0;
+}
+
+/**
+ * Keep the source text of the document in the resulting tree and
+ * record where each element starts and ends.
+ *
+ * When saving the document, elements which weren't modified since
+ * parsing are copied verbatim from the source, preserving quoting,
+ * character references, entity references and whitespace inside
+ * tags. Modified elements and their ancestors are serialized from
+ * the tree as usual. See #xmlNodeGetSource and #xmlNodeMarkModified.
+ * This also applies to elements with attributes or namespaces
+ * defaulted from the DTD and to elements containing entities
+ * substituted with XML_PARSE_NOENT.
+ *
+ * The text of the document entity is retained until the document is
+ * freed or #xmlDocDiscardSource is called. Streamed input isn't
+ * shrunk while parsing, so documents larger than 10 MB require
+ * XML_PARSE_HUGE.
+ *
+ * Only works with the pull parser (#xmlCtxtParseDocument and the
+ * xmlCtxtRead functions). Nothing is kept for documents which
+ * aren't well-formed.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param keep  whether to keep the source text
+ */
+void
+xmlCtxtSetSourceSpans(xmlParserCtxt *ctxt, int keep)
+{
+    if (ctxt == NULL)
+        return;
+    ctxt->keepSource = keep ? 1 : 0;
+}
+
+/**
+ * Add the byte counts and conversion time of an input to the
+ * statistics. Called when the input is popped. Replacement text
+ * of internal entities is accounted for in `entityBytes`.
+ *
+ * @param stats  parser statistics
+ * @param input  parser input
+ */
+void
+xmlCtxtAddInputStats(xmlParserStats *stats, xmlParserInput *input) {
+    unsigned long decoded;
+
+    if ((input == NULL) || (input->cur == NULL))
+        return;
+    /* The entity may already be freed */
+    if (input->flags & XML_INPUT_INTERNAL_ENTITY)
+        return;
+
+    decoded = input->consumed;
+    xmlSaturatedAddSizeT(&decoded, input->cur - input->base);
+    xmlSaturatedAdd(&stats->bytesDecoded, decoded);
+
+    if ((input->buf != NULL) && (input->buf->encoder != NULL)) {
+        xmlSaturatedAdd(&stats->bytesRead, input->buf->rawconsumed);
+        stats->encodingTime += input->buf->convTime;
+    } else {
+        xmlSaturatedAdd(&stats->bytesRead, decoded);
+    }
+}
+
+/**
+ * Clear the statistics and take a snapshot of the dictionary
+ * counters.
+ *
+ * @param ctxt  an XML parser context
+ */
+void
+xmlCtxtResetStats(xmlParserCtxt *ctxt) {
+    memset(&ctxt->stats, 0, sizeof(ctxt->stats));
+    ctxt->statsDictLookups = xmlDictGetLookups(ctxt->dict);
+    ctxt->statsDictSize = (ctxt->dict != NULL) ? xmlDictSize(ctxt->dict) : 0;
+}
+
+/**
+ * Return statistics about the current parse run, for example to log
+ * the cost of individual documents or to detect expensive inputs.
+ *
+ * The statistics are reset by #xmlCtxtReset and the xmlCtxtRead
+ * functions and can also be retrieved while parsing, for example
+ * from a SAX callback or between calls to #xmlParseChunk.
+ *
+ * Node, attribute and namespace counts are only maintained by the
+ * default tree-building SAX handlers. Dictionary counts include
+ * other users of a shared dictionary. The time spent in encoding
+ * conversion is only measured after calling #xmlCtxtSetStatsTiming.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param stats  pointer to a struct receiving the statistics
+ * @returns 0 on success or -1 if arguments are invalid.
+ */
+int
+xmlCtxtGetStats(xmlParserCtxt *ctxt, xmlParserStats *stats) {
+    unsigned long lookups, size;
+    int i;
+
+    if ((ctxt == NULL) || (stats == NULL))
+        return(-1);
+
+    *stats = ctxt->stats;
+
+    /* Inputs which are still open */
+    for (i = 0; i < ctxt->inputNr; i++)
+        xmlCtxtAddInputStats(stats, ctxt->inputTab[i]);
+
+    lookups = xmlDictGetLookups(ctxt->dict) - ctxt->statsDictLookups;
+    size = (ctxt->dict != NULL) ? xmlDictSize(ctxt->dict) : 0;
+    stats->dictInserts = (size > ctxt->statsDictSize) ?
+                         size - ctxt->statsDictSize : 0;
+    stats->dictHits = (lookups > stats->dictInserts) ?
+                      lookups - stats->dictInserts : 0;
+
+    stats->entityBytes = ctxt->sizeentcopy;
+    if (stats->bytesDecoded > 0)
+        stats->amplification = (double) ctxt->sizeentcopy /
+                               (double) stats->bytesDecoded;
+
+    return(0);
+}
+
+/**
+ * Also measure the time spent in encoding conversion, reported in
+ * the `encodingTime` member of #xmlParserStats. This reads the clock
+ * for every chunk of converted input and is disabled by default.
+ *
+ * Only applies to inputs opened after this call.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param enable  whether to measure conversion time
+ */
+void
+xmlCtxtSetStatsTiming(xmlParserCtxt *ctxt, int enable)
+{
+    if (ctxt == NULL)
+        return;
+    ctxt->statsTiming = enable ? 1 : 0;
+}
+
+/**
+ * Report CDATA sections in chunks of bounded size instead of
+ * collecting a whole section before calling the `cdataBlock` SAX
+ * handler. Use #xmlCtxtIsTextPartial in the handler to find out
+ * whether a section continues in the next call. The length limit
+ * for text content doesn't apply to CDATA sections in this mode.
+ *
+ * Character data is always reported in chunks.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param enable  whether to report CDATA sections in chunks
+ */
+void
+xmlCtxtSetChunkedText(xmlParserCtxt *ctxt, int enable)
+{
+    if (ctxt == NULL)
+        return;
+    ctxt->chunkedText = enable ? 1 : 0;
+}
+
+/**
+ * Check whether the text passed to the current `cdataBlock` or
+ * `characters` SAX handler is only part of a CDATA section and
+ * continues in the next call, see #xmlCtxtSetChunkedText.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @returns 1 if more text follows, 0 otherwise.
+ */
+int
+xmlCtxtIsTextPartial(xmlParserCtxt *ctxt)
+{
+    if (ctxt == NULL)
+        return(0);
+    return((ctxt->partialText & XML_TEXT_MORE) ? 1 : 0);
+}
+
+/**
+ * Pass the content of large text and CDATA nodes built by the
+ * default SAX2 handlers to a callback instead of storing it in
+ * the tree. Once the content of a node exceeds `threshold` bytes,
+ * the content so far and all further text of the node are passed
+ * to `sink` and the node is left empty. Peak memory then doesn't
+ * grow with the size of such nodes. CDATA sections are reported
+ * in chunks, see #xmlCtxtSetChunkedText.
+ *
+ * Content passed to the sink isn't subject to the length limit of
+ * text nodes, so XML_PARSE_HUGE isn't needed for large nodes.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param threshold  size in bytes above which content is passed on
+ * @param sink  the callback or NULL to store all content in the tree
+ * @param data  user data passed to the callback
+ * @returns 0 on success or -1 in case of error.
+ */
+int
+xmlCtxtSetTextSink(xmlParserCtxt *ctxt, int threshold, xmlTextSinkFunc sink,
+                   void *data)
+{
+    if ((ctxt == NULL) || (threshold < 0))
+        return(-1);
+
+    ctxt->textSink = sink;
+    ctxt->textSinkData = data;
+    ctxt->textSinkThreshold = threshold;
+    if (sink != NULL)
+        ctxt->chunkedText = 1;
+
+    return(0);
+}
+
+/**
+ * Only track byte positions while parsing and compute line and
+ * column numbers on demand by counting line breaks since the last
+ * checkpoint. Checkpoints are taken when line numbers are requested,
+ * for example to report an error or to record the line of a node,
+ * and before consumed input is discarded. This removes line
+ * bookkeeping from the loops which skip character data and
+ * whitespace.
+ *
+ * Columns count characters since the last line break. Has no
+ * effect on the HTML parser.
+ *
+ * Only applies to inputs opened after this call.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param enable  whether to compute line numbers on demand
+ */
+void
+xmlCtxtSetLazyLines(xmlParserCtxt *ctxt, int enable)
+{
+    if (ctxt == NULL)
+        return;
+    ctxt->lazyLines = enable ? 1 : 0;
+}
+
+/**
+ * Parse large documents with multiple threads.
+ *
+ * The content of the root element is split speculatively at start
+ * tags with the same name as the first child of the root. The chunks
+ * are parsed in parallel, each in the context of a copy of the root
+ * start tag, and the resulting trees are joined. Namespaces, IDs and
+ * line numbers are fixed up while joining.
+ *
+ * If a chunk reports any diagnostic, for example because a split
+ * wasn't at the top level, the whole document is parsed sequentially
+ * again, so results and errors are the same as without this option.
+ *
+ * Only documents in memory which are encoded in UTF-8 and which are
+ * larger than 256 KB per thread are split. Documents with a DOCTYPE
+ * are always parsed sequentially, as are documents parsed with custom
+ * SAX handlers, source spans, node info, text sinks, lazy IDs, pattern
+ * filters, memory budgets, time limits, XML_PARSE_SAX1 or
+ * XML_PARSE_ARENA. Parser statistics only cover the sequential parts.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param nbThreads  maximum number of threads or 0 to disable
+ * @returns 0 on success or -1 if threads aren't supported.
+ */
+int
+xmlCtxtSetParallel(xmlParserCtxt *ctxt, int nbThreads)
+{
+    if (ctxt == NULL)
+        return(-1);
+
+    if (nbThreads <= 1) {
+        ctxt->parallelThreads = 0;
+        return(0);
+    }
+
+#ifdef XML_PARSER_PARALLEL
+    ctxt->parallelThreads = nbThreads;
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+/**
+ * Parse a stream of concatenated documents with a push parser.
+ *
+ * Each document is passed to `func` as soon as the end tag of its
+ * root element was parsed. The parser then continues with the next
+ * document, keeping the dictionary, the input buffers, the encoding
+ * and the allocated stacks. Whitespace between documents is skipped.
+ * Comments and processing instructions following a root element
+ * belong to the prolog of the next document.
+ *
+ * The encoding of the first document applies to the whole stream.
+ * Errors stop the parser as usual, the partial document then stays
+ * in ctxt->myDoc.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param func  the callback or NULL to parse a single document
+ * @param data  user data passed to the callback
+ * @returns 0 on success or -1 in case of error.
+ */
+int
+xmlCtxtSetDocStream(xmlParserCtxt *ctxt, xmlDocStreamFunc func, void *data)
+{
+    if (ctxt == NULL)
+        return(-1);
+
+    ctxt->docStream = func;
+    ctxt->docStreamData = data;
+
+    return(0);
+}
+
+#ifdef LIBXML_PATTERN_ENABLED
+/**
+ * Only build the parts of the tree selected by streamable patterns.
+ *
+ * Elements matching one of the patterns are built with their whole
+ * subtree. Their ancestors are built with namespace declarations but
+ * without attributes, the root element is always built. All other
+ * content of elements is still parsed and checked for
+ * well-formedness, but no nodes are created for it. Content outside
+ * the root element isn't filtered.
+ *
+ * This allows to extract a few elements from a huge document with
+ * memory usage comparable to a streaming parser. The patterns are
+ * matched against element names only, see #xmlPatternGetStreamCtxt.
+ * They must be compiled without a dictionary or with the dictionary
+ * of the parser context.
+ *
+ * The patterns aren't copied and must stay valid while the context
+ * is used. Filtering is disabled with the HTML parser, the
+ * xmlreader, XML_PARSE_SAX1 and DTD validation.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param patterns  array of compiled patterns
+ * @param nbPatterns  number of patterns or 0 to disable filtering
+ * @returns 0 on success or -1 if a pattern isn't streamable or a
+ * memory allocation failed.
+ */
+int
+xmlCtxtSetPatternFilter(xmlParserCtxt *ctxt, xmlPattern **patterns,
+                        int nbPatterns) {
+    void **copy = NULL;
+    int i;
+
+    if ((ctxt == NULL) || (nbPatterns < 0) ||
+        ((patterns == NULL) && (nbPatterns > 0)))
+        return(-1);
+
+    for (i = 0; i < nbPatterns; i++) {
+        if (xmlPatternStreamable(patterns[i]) != 1)
+            return(-1);
+    }
+
+    if (nbPatterns > 0) {
+        copy = xmlMalloc(nbPatterns * sizeof(copy[0]));
+        if (copy == NULL)
+            return(-1);
+        for (i = 0; i < nbPatterns; i++)
+            copy[i] = patterns[i];
+    }
+
+    xmlCtxtFreeFilter(ctxt);
+    xmlFree(ctxt->filterPatterns);
+    ctxt->filterPatterns = copy;
+    ctxt->nbFilterPatterns = nbPatterns;
+
+    return(0);
+}
+#endif /* LIBXML_PATTERN_ENABLED */
+
+/**
+ * Set up the stream contexts of the pattern filter for a new
+ * document.
+ *
+ * @param ctxt  parser context
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+int
+xmlCtxtStartFilter(xmlParserCtxtPtr ctxt) {
+#ifdef LIBXML_PATTERN_ENABLED
+    int i;
+
+    xmlCtxtFreeFilter(ctxt);
+
+    if ((ctxt->nbFilterPatterns == 0) || (ctxt->html) ||
+        (ctxt->parseMode == XML_PARSE_READER) ||
+        (ctxt->options & XML_PARSE_SAX1) || (ctxt->validate))
+        return(0);
+
+    ctxt->filterStreams = xmlMalloc(ctxt->nbFilterPatterns *
+                                    sizeof(ctxt->filterStreams[0]));
+    if (ctxt->filterStreams == NULL)
+        return(-1);
+    for (i = 0; i < ctxt->nbFilterPatterns; i++) {
+        xmlStreamCtxtPtr stream;
+
+        stream = xmlPatternGetStreamCtxt(ctxt->filterPatterns[i]);
+        /* Push the document node for absolute patterns */
+        if ((stream == NULL) || (xmlStreamPush(stream, NULL, NULL) < 0)) {
+            xmlFreeStreamCtxt(stream);
+            while (--i >= 0)
+                xmlFreeStreamCtxt(ctxt->filterStreams[i]);
+            xmlFree(ctxt->filterStreams);
+            ctxt->filterStreams = NULL;
+            return(-1);
+        }
+        ctxt->filterStreams[i] = stream;
+    }
+#else
+    (void) ctxt;
+#endif /* LIBXML_PATTERN_ENABLED */
+
+    return(0);
+}
+
+/**
+ * Push an element start tag to the pattern filter.
+ *
+ * @param ctxt  parser context
+ * @param name  local name of the element
+ * @param ns  namespace name of the element (optional)
+ * @returns 1 if the element is selected, 0 if not, -1 if a memory
+ * allocation failed.
+ */
+int
+xmlCtxtFilterPush(xmlParserCtxtPtr ctxt, const xmlChar *name,
+                  const xmlChar *ns) {
+    int ret = 0;
+#ifdef LIBXML_PATTERN_ENABLED
+    int i;
+
+    /* All streams must see the element to stay balanced */
+    for (i = 0; i < ctxt->nbFilterPatterns; i++) {
+        int res = xmlStreamPush(ctxt->filterStreams[i], name, ns);
+
+        if (res < 0)
+            ret = -1;
+        else if ((res == 1) && (ret == 0))
+            ret = 1;
+    }
+#else
+    (void) ctxt;
+    (void) name;
+    (void) ns;
+#endif /* LIBXML_PATTERN_ENABLED */
+
+    return(ret);
+}
+
+/**
+ * Pop an element from the pattern filter.
+ *
+ * @param ctxt  parser context
+ */
+void
+xmlCtxtFilterPop(xmlParserCtxtPtr ctxt) {
+#ifdef LIBXML_PATTERN_ENABLED
+    int i;
+
+    for (i = 0; i < ctxt->nbFilterPatterns; i++)
+        xmlStreamPop(ctxt->filterStreams[i]);
+#else
+    (void) ctxt;
+#endif /* LIBXML_PATTERN_ENABLED */
+}
+
+/**
+ * Free the stream contexts of the pattern filter.
+ *
+ * @param ctxt  parser context
+ */
+void
+xmlCtxtFreeFilter(xmlParserCtxtPtr ctxt) {
+#ifdef LIBXML_PATTERN_ENABLED
+    int i;
+
+    if (ctxt->filterStreams != NULL) {
+        for (i = 0; i < ctxt->nbFilterPatterns; i++)
+            xmlFreeStreamCtxt(ctxt->filterStreams[i]);
+        xmlFree(ctxt->filterStreams);
+        ctxt->filterStreams = NULL;
+    }
+#endif /* LIBXML_PATTERN_ENABLED */
+    ctxt->filterDepth = 0;
+}
+
+/************************************************************************
+ *									*
+ *			Parallel parsing				*
+ *									*
+ ************************************************************************/
+
+#ifdef XML_PARSER_PARALLEL
+
+/* Minimum size of the chunks parsed by separate threads */
+#define XML_PARALLEL_MIN_CHUNK (256 * 1024)
+
+typedef struct _xmlParallelRun xmlParallelRun;
+
+typedef struct {
+    xmlParallelRun *run;
+    /* region of the document covered by the chunk */
+    const xmlChar *start;
+    const xmlChar *end;
+    /* the input of the chunk: root start tag, region and end tag */
+    const xmlChar *parts[3];
+    size_t sizes[3];
+    int part;
+    size_t offset;
+    xmlDocPtr doc;
+    int failed;
+    /* line breaks in the region and line number adjustment */
+    int newlines;
+    int lineOffset;
+} xmlParallelChunk;
+
+struct _xmlParallelRun {
+    xmlParserCtxtPtr ctxt;
+    const char *url;
+    /* dictionary shared by all chunks */
+    xmlDictPtr dict;
+    /* text of the root start tag and the matching end tag */
+    const xmlChar *tag;
+    size_t tagLen;
+    int tagNewlines;
+    xmlChar *endTag;
+    size_t endTagLen;
+    xmlParallelChunk *chunks;
+    int nbChunks;
+    /* the resulting document */
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    xmlNsPtr xmlNs;
+};
+
+static int
+xmlParallelRead(void *context, char *buffer, int len) {
+    xmlParallelChunk *chunk = context;
+
+    while (chunk->part < 3) {
+        size_t avail = chunk->sizes[chunk->part] - chunk->offset;
+
+        if (avail > 0) {
+            if (avail > (size_t) len)
+                avail = len;
+            memcpy(buffer, chunk->parts[chunk->part] + chunk->offset, avail);
+            chunk->offset += avail;
+            return(avail);
+        }
+
+        chunk->part++;
+        chunk->offset = 0;
+    }
+
+    return(0);
+}
+
+static void
+xmlParallelError(void *data, const xmlError *error ATTRIBUTE_UNUSED) {
+    xmlParallelChunk *chunk = data;
+
+    chunk->failed = 1;
+}
+
+static int
+xmlParallelCountLines(const xmlChar *cur, const xmlChar *end) {
+    const xmlChar *nl;
+    int count = 0;
+
+    while ((nl = memchr(cur, '\n', end - cur)) != NULL) {
+        if (count < INT_MAX)
+            count++;
+        cur = nl + 1;
+    }
+
+    return(count);
+}
+
+/*
+ * Parse a chunk as a document of its own. Chunks after the first are
+ * wrapped in a copy of the root element, so the namespaces declared
+ * on the root are in scope. Any diagnostic means that the speculative
+ * split was wrong or that the document has errors, which are then
+ * reported by the sequential parser.
+ */
+static void
+xmlParallelParseChunk(void *arg) {
+    xmlParallelChunk *chunk = arg;
+    xmlParallelRun *run = chunk->run;
+    xmlParserCtxtPtr ctxt;
+    int first = (chunk == &run->chunks[0]);
+
+    ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL) {
+        chunk->failed = 1;
+        return;
+    }
+    xmlCtxtSetDict(ctxt, run->dict);
+    xmlCtxtSetErrorHandler(ctxt, xmlParallelError, chunk);
+
+    chunk->doc = xmlCtxtReadIO(ctxt, xmlParallelRead, NULL, chunk,
+                               first ? run->url : NULL, NULL,
+                               run->ctxt->options);
+    if ((chunk->doc == NULL) || (!ctxt->wellFormed) ||
+        (ctxt->errNo != XML_ERR_OK) ||
+        (xmlDocGetRootElement(chunk->doc) == NULL))
+        chunk->failed = 1;
+
+    xmlFreeParserCtxt(ctxt);
+
+    chunk->newlines = xmlParallelCountLines(chunk->start, chunk->end);
+}
+
+static xmlNsPtr
+xmlParallelMapNs(xmlParallelRun *run, xmlParallelChunk *chunk, xmlNsPtr ns) {
+    xmlNsPtr from, to;
+
+    if (ns == NULL)
+        return(NULL);
+    if (ns == chunk->doc->oldNs)
+        return(run->xmlNs);
+
+    /* Both roots declare the same namespaces in the same order */
+    from = xmlDocGetRootElement(chunk->doc)->nsDef;
+    to = run->root->nsDef;
+    while ((from != NULL) && (to != NULL)) {
+        if (from == ns)
+            return(to);
+        from = from->next;
+        to = to->next;
+    }
+
+    return(ns);
+}
+
+static void
+xmlParallelFixLine(xmlNodePtr node, int offset, int bigLines) {
+    long line;
+
+    if (node->line == 0)
+        return;
+
+    if ((node->line == USHRT_MAX) && (bigLines) &&
+        (node->type == XML_TEXT_NODE) && (node->psvi != NULL))
+        line = XML_PTR_TO_INT(node->psvi);
+    else if (node->line == USHRT_MAX)
+        return;
+    else
+        line = node->line;
+
+    line += offset;
+    if (line < USHRT_MAX) {
+        node->line = line;
+    } else {
+        node->line = USHRT_MAX;
+        if ((bigLines) && (node->type == XML_TEXT_NODE))
+            node->psvi = XML_INT_TO_PTR(line);
+    }
+}
+
+/*
+ * Move the nodes of a subtree to the resulting document, map
+ * references to namespaces declared on the root element of the chunk
+ * and adjust line numbers.
+ */
+static void
+xmlParallelFixTree(xmlParallelRun *run, xmlParallelChunk *chunk,
+                   xmlNodePtr tree) {
+    int bigLines = (run->ctxt->options & XML_PARSE_BIG_LINES) ? 1 : 0;
+    xmlNodePtr cur = tree;
+
+    while (1) {
+        cur->doc = run->doc;
+        xmlParallelFixLine(cur, chunk->lineOffset, bigLines);
+
+        if (cur->type == XML_ELEMENT_NODE) {
+            xmlAttrPtr attr;
+
+            cur->ns = xmlParallelMapNs(run, chunk, cur->ns);
+            for (attr = cur->properties; attr != NULL; attr = attr->next) {
+                xmlNodePtr text;
+
+                attr->doc = run->doc;
+                attr->ns = xmlParallelMapNs(run, chunk, attr->ns);
+                for (text = attr->children; text != NULL; text = text->next)
+                    text->doc = run->doc;
+            }
+
+            if (cur->children != NULL) {
+                cur = cur->children;
+                continue;
+            }
+        }
+
+        while ((cur != tree) && (cur->next == NULL))
+            cur = cur->parent;
+        if (cur == tree)
+            break;
+        cur = cur->next;
+    }
+}
+
+static void
+xmlParallelFixChunk(void *arg) {
+    xmlParallelChunk *chunk = arg;
+    xmlParallelRun *run = chunk->run;
+    xmlNodePtr root = xmlDocGetRootElement(chunk->doc);
+    xmlNodePtr cur;
+
+    for (cur = root->children; cur != NULL; cur = cur->next) {
+        cur->parent = run->root;
+        xmlParallelFixTree(run, chunk, cur);
+    }
+
+    /* Comments and PIs after the root element */
+    for (cur = root->next; cur != NULL; cur = cur->next) {
+        cur->parent = (xmlNodePtr) run->doc;
+        xmlParallelFixTree(run, chunk, cur);
+    }
+}
+
+typedef struct {
+    xmlHashTablePtr seen;
+    /* root element of the current chunk or NULL for the first chunk */
+    xmlNodePtr root;
+    xmlAttrPtr *attrs;
+    xmlChar **values;
+    int nbIds;
+    int maxIds;
+    int failed;
+} xmlParallelIds;
+
+static void
+xmlParallelScanId(void *payload, void *data, const xmlChar *name) {
+    xmlIDPtr id = payload;
+    xmlParallelIds *ids = data;
+    xmlAttrPtr attr = id->attr;
+    xmlChar *value;
+
+    /* IDs on the copies of the root element are dropped */
+    if ((attr == NULL) || (attr->parent == NULL) ||
+        ((ids->root != NULL) && (attr->parent == ids->root)))
+        return;
+
+    if (xmlHashAddEntry(ids->seen, name, ids) < 0) {
+        ids->failed = 1;
+        return;
+    }
+
+    if (ids->root == NULL)
+        return;
+
+    if (ids->nbIds >= ids->maxIds) {
+        xmlAttrPtr *attrs;
+        xmlChar **values;
+        int newSize;
+
+        newSize = xmlGrowCapacity(ids->maxIds, sizeof(attrs[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            ids->failed = 1;
+            return;
+        }
+        attrs = xmlRealloc(ids->attrs, newSize * sizeof(attrs[0]));
+        if (attrs == NULL) {
+            ids->failed = 1;
+            return;
+        }
+        ids->attrs = attrs;
+        values = xmlRealloc(ids->values, newSize * sizeof(values[0]));
+        if (values == NULL) {
+            ids->failed = 1;
+            return;
+        }
+        ids->values = values;
+        ids->maxIds = newSize;
+    }
+
+    value = xmlStrdup(id->value);
+    if (value == NULL) {
+        ids->failed = 1;
+        return;
+    }
+    ids->attrs[ids->nbIds] = attr;
+    ids->values[ids->nbIds] = value;
+    ids->nbIds++;
+}
+
+/*
+ * Take the IDs out of the chunks other than the first. IDs defined
+ * in more than one chunk would be reported by the sequential parser.
+ */
+static int
+xmlParallelCollectIds(xmlParallelRun *run, xmlParallelIds *ids) {
+    int i;
+
+    ids->seen = xmlHashCreate(0);
+    if (ids->seen == NULL)
+        return(-1);
+
+    for (i = 0; i < run->nbChunks; i++) {
+        xmlDocPtr doc = run->chunks[i].doc;
+
+        if (doc->ids == NULL)
+            continue;
+        ids->root = (i > 0) ? xmlDocGetRootElement(doc) : NULL;
+        xmlHashScan(doc->ids, xmlParallelScanId, ids);
+        if (ids->failed)
+            return(-1);
+        if (i > 0) {
+            xmlFreeIDTable(doc->ids);
+            doc->ids = NULL;
+        }
+    }
+
+    return(0);
+}
+
+/*
+ * Register the collected IDs with the resulting document.
+ */
+static int
+xmlParallelAddIds(xmlParallelIds *ids) {
+    int i;
+
+    for (i = 0; i < ids->nbIds; i++) {
+        if (xmlAddIDSafe(ids->attrs[i], ids->values[i]) <= 0)
+            return(-1);
+    }
+
+    return(0);
+}
+
+static void
+xmlParallelFreeIds(xmlParallelIds *ids) {
+    int i;
+
+    for (i = 0; i < ids->nbIds; i++)
+        xmlFree(ids->values[i]);
+    xmlFree(ids->values);
+    xmlFree(ids->attrs);
+    xmlHashFree(ids->seen, NULL);
+}
+
+static const xmlChar *
+xmlParallelFind(const xmlChar *cur, const xmlChar *end, const char *str) {
+    size_t len = strlen(str);
+
+    while ((size_t) (end - cur) >= len) {
+        cur = memchr(cur, str[0], end - cur - len + 1);
+        if (cur == NULL)
+            return(NULL);
+        if (memcmp(cur, str, len) == 0)
+            return(cur);
+        cur++;
+    }
+
+    return(NULL);
+}
+
+static int
+xmlParallelIsNameStart(int c) {
+    return(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
+           (c == '_') || (c == ':') || (c >= 0x80));
+}
+
+static const xmlChar *
+xmlParallelNameEnd(const xmlChar *cur, const xmlChar *end) {
+    while ((cur < end) && (!IS_BLANK_CH(*cur)) && (*cur != '/') &&
+           (*cur != '>'))
+        cur++;
+    return(cur);
 }
 
-/**
- * Applies the options to the parser context. Unset options are
- * cleared.
- *
- * @since 2.13.0
- *
- * With older versions, you can use #xmlCtxtUseOptions.
- *
- * @param ctxt  an XML parser context
- * @param options  a bitmask of xmlParserOption values
- * @returns 0 in case of success, the set of unknown or unimplemented options
- *         in case of error.
+/*
+ * Skip the prolog and return the start of the root element. Returns
+ * NULL if the document has a DOCTYPE or declares an encoding other
+ * than UTF-8.
  */
-int
-xmlCtxtSetOptions(xmlParserCtxt *ctxt, int options)
-{
-#ifdef LIBXML_HTML_ENABLED
-    if ((ctxt != NULL) && (ctxt->html))
-        return(htmlCtxtSetOptions(ctxt, options));
-#endif
+static const xmlChar *
+xmlParallelFindRoot(const xmlChar *cur, const xmlChar *end) {
+    const xmlChar *close;
 
-    return(xmlCtxtSetOptionsInternal(ctxt, options, 0));
+    if ((end - cur >= 3) &&
+        (cur[0] == 0xEF) && (cur[1] == 0xBB) && (cur[2] == 0xBF))
+        cur += 3;
+
+    if ((end - cur >= 6) && (memcmp(cur, "<?xml", 5) == 0) &&
+        (IS_BLANK_CH(cur[5]))) {
+        const xmlChar *enc;
+
+        close = xmlParallelFind(cur, end, "?>");
+        if (close == NULL)
+            return(NULL);
+        enc = xmlParallelFind(cur, close, "encoding");
+        if (enc != NULL) {
+            enc += 8;
+            while ((enc < close) && ((IS_BLANK_CH(*enc)) || (*enc == '=')))
+                enc++;
+            if ((close - enc < 7) || ((*enc != '"') && (*enc != '\'')) ||
+                (xmlStrncasecmp(enc + 1, BAD_CAST "UTF-8", 5) != 0) ||
+                (enc[6] != *enc))
+                return(NULL);
+        }
+        cur = close + 2;
+    }
+
+    while (cur < end) {
+        if (IS_BLANK_CH(*cur)) {
+            cur++;
+        } else if ((end - cur >= 4) && (memcmp(cur, "<!--", 4) == 0)) {
+            close = xmlParallelFind(cur + 4, end, "-->");
+            if (close == NULL)
+                return(NULL);
+            cur = close + 3;
+        } else if ((end - cur >= 2) && (memcmp(cur, "<?", 2) == 0)) {
+            close = xmlParallelFind(cur + 2, end, "?>");
+            if (close == NULL)
+                return(NULL);
+            cur = close + 2;
+        } else if ((end - cur >= 2) && (cur[0] == '<') &&
+                   (xmlParallelIsNameStart(cur[1]))) {
+            return(cur);
+        } else {
+            return(NULL);
+        }
+    }
+
+    return(NULL);
 }
 
-/**
- * Get the current options of the parser context.
- *
- * @since 2.14.0
- *
- * @param ctxt  an XML parser context
- * @returns the current options set in the parser context, or -1 if ctxt is NULL.
+/*
+ * Find the next start tag named `name`, which is likely a child of
+ * the root element if the first child has the same name.
  */
-int
-xmlCtxtGetOptions(xmlParserCtxt *ctxt)
-{
-    if (ctxt == NULL)
-        return(-1);
+static const xmlChar *
+xmlParallelFindSplit(const xmlChar *cur, const xmlChar *end,
+                     const xmlChar *name, size_t len) {
+    while ((size_t) (end - cur) > len + 1) {
+        cur = memchr(cur, '<', end - cur - len - 1);
+        if (cur == NULL)
+            return(NULL);
+        if ((memcmp(cur + 1, name, len) == 0) &&
+            ((IS_BLANK_CH(cur[len + 1])) || (cur[len + 1] == '/') ||
+             (cur[len + 1] == '>')))
+            return(cur);
+        cur++;
+    }
 
-    return(ctxt->options);
+    return(NULL);
 }
 
-/**
- * Applies the options to the parser context. The following options
- * are never cleared and can only be enabled:
- *
- * - XML_PARSE_NOERROR
- * - XML_PARSE_NOWARNING
- * - XML_PARSE_NONET
- * - XML_PARSE_NSCLEAN
- * - XML_PARSE_NOCDATA
- * - XML_PARSE_COMPACT
- * - XML_PARSE_OLD10
- * - XML_PARSE_HUGE
- * - XML_PARSE_OLDSAX
- * - XML_PARSE_IGNORE_ENC
- * - XML_PARSE_BIG_LINES
- *
- * @deprecated Use #xmlCtxtSetOptions.
- *
- * @param ctxt  an XML parser context
- * @param options  a combination of xmlParserOption
- * @returns 0 in case of success, the set of unknown or unimplemented options
- *         in case of error.
+/*
+ * Split the content of the root element at start tags which are
+ * likely children of the root, parse the chunks in parallel, then
+ * join the results. A wrong guess leaves a chunk unbalanced, which is
+ * a well-formedness error, so results are only used if no chunk
+ * reported any diagnostic. Returns NULL if the document must be
+ * parsed sequentially.
  */
-int
-xmlCtxtUseOptions(xmlParserCtxt *ctxt, int options)
-{
-    int keepMask;
+static xmlDocPtr
+xmlCtxtParseParallel(xmlParserCtxtPtr ctxt, xmlParserInputPtr input) {
+    xmlParallelRun run;
+    xmlParallelIds ids;
+    xmlTaskGroup *group = NULL;
+    const xmlChar *base, *end, *rootStart, *nameEnd, *content, *cur;
+    const xmlChar *child, *childEnd;
+    const xmlChar **splits = NULL;
+    xmlDocPtr ret = NULL;
+    size_t chunkSize;
+    int maxChunks, nbSplits, lines, quote, i;
+
+    memset(&run, 0, sizeof(run));
+    memset(&ids, 0, sizeof(ids));
+
+    if ((ctxt->html) || (ctxt->record_info) || (ctxt->keepSource) ||
+        (ctxt->textSink != NULL) || (ctxt->lazyIds) ||
+        (ctxt->nbFilterPatterns > 0) ||
+        (ctxt->memBudget != NULL) || (ctxt->timeLimit != 0) ||
+        (ctxt->options & (XML_PARSE_SAX1 | XML_PARSE_ARENA)) ||
+        (ctxt->userData != ctxt) || (ctxt->sax == NULL) ||
+        (ctxt->schemaValid != NULL) ||
+        (ctxt->sax->startDocument != xmlSAX2StartDocument) ||
+        (ctxt->sax->startElementNs != xmlSAX2StartElementNs) ||
+        (ctxt->sax->endElementNs != xmlSAX2EndElementNs) ||
+        (ctxt->sax->characters != xmlSAX2Characters))
+        return(NULL);
 
-#ifdef LIBXML_HTML_ENABLED
-    if ((ctxt != NULL) && (ctxt->html))
-        return(htmlCtxtUseOptions(ctxt, options));
-#endif
+    /* Only documents which are entirely in memory and UTF-8 */
+    if ((input->buf == NULL) || (input->buf->encoder != NULL) ||
+        (input->flags & XML_INPUT_HAS_ENCODING))
+        return(NULL);
+    if (input->buf->readcallback == NULL) {
+        base = input->cur;
+        end = input->end;
+    } else {
+        size_t size;
+
+        if (xmlParserInputBufferGetMemory(input->buf, &base, &size) < 0)
+            return(NULL);
+        end = base + size;
+    }
+    maxChunks = ctxt->parallelThreads;
+    if ((size_t) (end - base) / XML_PARALLEL_MIN_CHUNK < (size_t) maxChunks)
+        maxChunks = (end - base) / XML_PARALLEL_MIN_CHUNK;
+    if (maxChunks < 2)
+        return(NULL);
+
+    rootStart = xmlParallelFindRoot(base, end);
+    if (rootStart == NULL)
+        return(NULL);
+    nameEnd = xmlParallelNameEnd(rootStart + 1, end);
+
+    quote = 0;
+    for (cur = nameEnd; cur < end; cur++) {
+        if (quote) {
+            if (*cur == quote)
+                quote = 0;
+        } else if ((*cur == '"') || (*cur == '\'')) {
+            quote = *cur;
+        } else if (*cur == '>') {
+            break;
+        }
+    }
+    if ((cur >= end) || (cur[-1] == '/'))
+        return(NULL);
+    content = cur + 1;
+
+    /* The name of the first child */
+    child = content;
+    while (1) {
+        child = memchr(child, '<', end - child);
+        if ((child == NULL) || (end - child < 2))
+            return(NULL);
+        child++;
+        if (xmlParallelIsNameStart(*child))
+            break;
+    }
+    childEnd = xmlParallelNameEnd(child, end);
+
+    splits = xmlMalloc(maxChunks * sizeof(splits[0]));
+    if (splits == NULL)
+        return(NULL);
+    chunkSize = (end - content) / maxChunks;
+    nbSplits = 0;
+    cur = content;
+    for (i = 1; i < maxChunks; i++) {
+        const xmlChar *target = content + i * chunkSize;
+
+        if (target <= cur)
+            target = cur + 1;
+        cur = xmlParallelFindSplit(target, end, child, childEnd - child);
+        if (cur == NULL)
+            break;
+        splits[nbSplits++] = cur;
+    }
+    if (nbSplits == 0)
+        goto done;
+
+    run.ctxt = ctxt;
+    run.url = input->filename;
+    run.tag = rootStart;
+    run.tagLen = content - rootStart;
+    run.tagNewlines = xmlParallelCountLines(rootStart, content);
+    run.endTagLen = nameEnd - rootStart + 2;
+    run.endTag = xmlMalloc(run.endTagLen + 1);
+    if (run.endTag == NULL)
+        goto done;
+    run.endTag[0] = '<';
+    run.endTag[1] = '/';
+    memcpy(run.endTag + 2, rootStart + 1, nameEnd - rootStart - 1);
+    run.endTag[run.endTagLen - 1] = '>';
+    run.endTag[run.endTagLen] = 0;
+
+    run.nbChunks = nbSplits + 1;
+    run.chunks = xmlMalloc(run.nbChunks * sizeof(run.chunks[0]));
+    if (run.chunks == NULL)
+        goto done;
+    memset(run.chunks, 0, run.nbChunks * sizeof(run.chunks[0]));
+    for (i = 0; i < run.nbChunks; i++) {
+        xmlParallelChunk *chunk = &run.chunks[i];
+
+        chunk->run = &run;
+        chunk->start = (i == 0) ? base : splits[i - 1];
+        chunk->end = (i == nbSplits) ? end : splits[i];
+        if (i > 0) {
+            chunk->parts[0] = run.tag;
+            chunk->sizes[0] = run.tagLen;
+        }
+        chunk->parts[1] = chunk->start;
+        chunk->sizes[1] = chunk->end - chunk->start;
+        if (i < nbSplits) {
+            chunk->parts[2] = run.endTag;
+            chunk->sizes[2] = run.endTagLen;
+        }
+    }
+
+    if (xmlDictIsConcurrent(ctxt->dict)) {
+        run.dict = ctxt->dict;
+        xmlDictReference(run.dict);
+    } else {
+        run.dict = xmlDictCreateConcurrent();
+        if (run.dict == NULL)
+            goto done;
+    }
+
+    group = xmlNewTaskGroup();
+    if (group == NULL)
+        goto done;
+    for (i = 1; i < run.nbChunks; i++) {
+        if (xmlTaskGroupSubmit(group, xmlParallelParseChunk,
+                               &run.chunks[i]) < 0)
+            xmlParallelParseChunk(&run.chunks[i]);
+    }
+    xmlParallelParseChunk(&run.chunks[0]);
+    xmlTaskGroupJoin(group);
+
+    lines = 1;
+    for (i = 0; i < run.nbChunks; i++) {
+        xmlParallelChunk *chunk = &run.chunks[i];
+
+        if (chunk->failed)
+            goto done;
+        if (i > 0)
+            chunk->lineOffset = lines - 1 - run.tagNewlines;
+        if (lines > INT_MAX - chunk->newlines)
+            goto done;
+        lines += chunk->newlines;
+    }
+
+    run.doc = run.chunks[0].doc;
+    run.root = xmlDocGetRootElement(run.doc);
+    for (i = 1; i < run.nbChunks; i++) {
+        xmlDocPtr doc = run.chunks[i].doc;
+        xmlNsPtr from = xmlDocGetRootElement(doc)->nsDef;
+        xmlNsPtr to = run.root->nsDef;
+
+        while ((from != NULL) && (to != NULL) &&
+               (xmlStrEqual(from->prefix, to->prefix))) {
+            from = from->next;
+            to = to->next;
+        }
+        if ((from != NULL) || (to != NULL))
+            goto done;
+
+        if ((doc->oldNs != NULL) && (run.xmlNs == NULL)) {
+            run.xmlNs = xmlSearchNs(run.doc, run.root, BAD_CAST "xml");
+            if (run.xmlNs == NULL)
+                goto done;
+        }
+    }
+
+    if (xmlParallelCollectIds(&run, &ids) < 0)
+        goto done;
 
     /*
-     * For historic reasons, some options can only be enabled.
+     * Nothing can fail from here on except adding the IDs, which
+     * happens after all nodes were moved to the first document.
      */
-    keepMask = XML_PARSE_NOERROR |
-               XML_PARSE_NOWARNING |
-               XML_PARSE_NONET |
-               XML_PARSE_NSCLEAN |
-               XML_PARSE_NOCDATA |
-               XML_PARSE_COMPACT |
-               XML_PARSE_OLD10 |
-               XML_PARSE_HUGE |
-               XML_PARSE_OLDSAX |
-               XML_PARSE_IGNORE_ENC |
-               XML_PARSE_BIG_LINES;
+    for (i = 1; i < run.nbChunks; i++) {
+        if (xmlTaskGroupSubmit(group, xmlParallelFixChunk,
+                               &run.chunks[i]) < 0)
+            xmlParallelFixChunk(&run.chunks[i]);
+    }
+    xmlTaskGroupJoin(group);
 
-    return(xmlCtxtSetOptionsInternal(ctxt, options, keepMask));
-}
+    for (i = 1; i < run.nbChunks; i++) {
+        xmlDocPtr doc = run.chunks[i].doc;
+        xmlNodePtr root = xmlDocGetRootElement(doc);
 
-/**
- * To protect against exponential entity expansion ("billion laughs"), the
- * size of serialized output is (roughly) limited to the input size
- * multiplied by this factor. The default value is 5.
- *
- * When working with documents making heavy use of entity expansion, it can
- * be necessary to increase the value. For security reasons, this should only
- * be considered when processing trusted input.
- *
- * @param ctxt  an XML parser context
- * @param maxAmpl  maximum amplification factor
- */
-void
-xmlCtxtSetMaxAmplification(xmlParserCtxt *ctxt, unsigned maxAmpl)
-{
-    if (ctxt == NULL)
-        return;
-    ctxt->maxAmpl = maxAmpl;
+        if (root->children != NULL) {
+            if (run.root->last == NULL) {
+                run.root->children = root->children;
+            } else {
+                run.root->last->next = root->children;
+                root->children->prev = run.root->last;
+            }
+            run.root->last = root->last;
+            root->children = NULL;
+            root->last = NULL;
+        }
+
+        if (root->next != NULL) {
+            root->next->prev = run.doc->last;
+            run.doc->last->next = root->next;
+            run.doc->last = doc->last;
+            root->next = NULL;
+            doc->last = root;
+        }
+    }
+
+    if (xmlParallelAddIds(&ids) < 0)
+        goto done;
+
+    /* Keep the dictionary of the context and the document in sync */
+    if (run.dict != ctxt->dict)
+        xmlCtxtSetDict(ctxt, run.dict);
+
+    ret = run.doc;
+    run.chunks[0].doc = NULL;
+
+done:
+    if (group != NULL)
+        xmlFreeTaskGroup(group);
+    if (run.chunks != NULL) {
+        for (i = 0; i < run.nbChunks; i++)
+            xmlFreeDoc(run.chunks[i].doc);
+        xmlFree(run.chunks);
+    }
+    xmlParallelFreeIds(&ids);
+    xmlDictFree(run.dict);
+    xmlFree(run.endTag);
+    xmlFree(splits);
+    return(ret);
 }
 
+#endif /* XML_PARSER_PARALLEL */
+
 /**
  * Parse an XML document and return the resulting document tree.
  * Takes ownership of the input object.
@@ -13334,14 +16478,30 @@ xmlCtxtParseDocument(xmlParserCtxt *ctxt, xmlParserInput *input)
     while (ctxt->inputNr > 0)
         xmlFreeInputStream(xmlCtxtPopInput(ctxt));
 
+#ifdef XML_PARSER_PARALLEL
+    if (ctxt->parallelThreads > 1) {
+        ret = xmlCtxtParseParallel(ctxt, input);
+        if (ret != NULL) {
+            xmlFreeInputStream(input);
+            return(ret);
+        }
+    }
+#endif
+
     if (xmlCtxtPushInput(ctxt, input) < 0) {
         xmlFreeInputStream(input);
         return(NULL);
     }
 
+    xmlCtxtFreeSourceSpans(ctxt);
+    if (ctxt->keepSource)
+        input->flags |= XML_INPUT_KEEP_SOURCE;
+
     xmlParseDocument(ctxt);
 
     ret = xmlCtxtGetDocument(ctxt);
+    if ((ret != NULL) && (ctxt->keepSource))
+        xmlCtxtAttachSource(ctxt, ret);
 
     /* assert(ctxt->inputNr == 1); */
     while (ctxt->inputNr > 0)
@@ -13715,3 +16875,167 @@ xmlCtxtReadIO(xmlParserCtxt *ctxt, xmlInputReadCallback ioread,
     return(xmlCtxtParseDocument(ctxt, input));
 }
 
+/* Maximum number of pool workers plus the joining thread */
+#define XML_BATCH_MAX_CTXTS 65
+
+/*
+ * State shared by the tasks of #xmlReadBatch
+ */
+typedef struct {
+    xmlBatchItem *items;
+    xmlParserCtxtPool *pool;
+    xmlDictPtr dict;
+    const char *encoding;
+    int options;
+    xmlBatchDocFunc func;
+    void *data;
+} xmlBatchRun;
+
+typedef struct {
+    xmlBatchRun *run;
+    int index;
+    int success;
+} xmlBatchTask;
+
+static void
+xmlBatchParse(void *arg) {
+    xmlBatchTask *task = arg;
+    xmlBatchRun *run = task->run;
+    xmlBatchItem *item = &run->items[task->index];
+    xmlParserCtxtPtr ctxt;
+    const xmlError *error = NULL;
+    xmlDocPtr doc = NULL;
+
+    ctxt = xmlParserCtxtPoolAcquire(run->pool);
+    if (ctxt == NULL) {
+        item->error = XML_ERR_NO_MEMORY;
+        goto done;
+    }
+
+    /*
+     * The frozen dictionary is shared without locking. Each document
+     * gets its own dictionary for new strings.
+     */
+    if (run->dict != NULL) {
+        xmlDictPtr dict = xmlDictCreateSub(run->dict);
+
+        if (dict == NULL) {
+            item->error = XML_ERR_NO_MEMORY;
+            goto done;
+        }
+        xmlCtxtSetDict(ctxt, dict);
+        xmlDictFree(dict);
+    }
+
+    if (item->buffer != NULL)
+        doc = xmlCtxtReadMemory(ctxt, item->buffer, item->size,
+                                item->filename, run->encoding, run->options);
+    else
+        doc = xmlCtxtReadFile(ctxt, item->filename, run->encoding,
+                              run->options);
+
+    error = xmlCtxtGetLastError(ctxt);
+    item->error = (error != NULL) ? error->code : XML_ERR_OK;
+    task->success = (doc != NULL);
+
+done:
+    if (run->func != NULL)
+        run->func(run->data, task->index, doc, error);
+    else
+        item->doc = doc;
+
+    xmlParserCtxtPoolRelease(run->pool, ctxt);
+}
+
+/**
+ * Parse a batch of documents on the library's thread pool, see
+ * #xmlThreadPoolSetSize.
+ *
+ * Each item is parsed from `buffer` if set, otherwise from the file
+ * `filename`. The parser contexts are taken from a pool, so their
+ * memory is reused between documents. Shared DTDs registered with
+ * #xmlDtdCacheAdd and the catalogs are used by all threads.
+ *
+ * If `dict` is provided, it is frozen with #xmlDictFreeze and shared
+ * by all documents as sub-dictionary, see #xmlDictCreateSub. Names
+ * found in it aren't copied into the dictionaries of the documents.
+ *
+ * If `func` is NULL, the resulting documents are stored in the
+ * `doc` member of the items. Otherwise, they are passed to `func`
+ * as soon as they're parsed. The `error` member of the items is
+ * always set.
+ *
+ * Errors are reported to the default error handler from several
+ * threads. Pass XML_PARSE_NOERROR to suppress them.
+ *
+ * @since 2.16.0
+ *
+ * @param items  the documents to parse
+ * @param nbItems  number of items
+ * @param dict  a dictionary shared between documents (optional)
+ * @param encoding  the document encoding (optional)
+ * @param options  a combination of xmlParserOption
+ * @param func  callback receiving the documents (optional)
+ * @param data  user data for the callback
+ * @returns the number of documents parsed or -1 if the arguments
+ * are invalid or a memory allocation failed.
+ */
+int
+xmlReadBatch(xmlBatchItem *items, int nbItems, xmlDict *dict,
+             const char *encoding, int options,
+             xmlBatchDocFunc func, void *data)
+{
+    xmlBatchRun run;
+    xmlBatchTask *tasks;
+    xmlTaskGroup *group;
+    int i, ret = 0;
+
+    if ((nbItems < 0) || ((items == NULL) && (nbItems > 0)))
+        return(-1);
+    if (nbItems == 0)
+        return(0);
+
+    for (i = 0; i < nbItems; i++) {
+        items[i].doc = NULL;
+        items[i].error = XML_ERR_OK;
+    }
+
+    memset(&run, 0, sizeof(run));
+    run.items = items;
+    run.dict = dict;
+    run.encoding = encoding;
+    run.options = options;
+    run.func = func;
+    run.data = data;
+
+    if ((dict != NULL) && (xmlDictFreeze(dict) < 0))
+        return(-1);
+
+    tasks = xmlMalloc(nbItems * sizeof(tasks[0]));
+    if (tasks == NULL)
+        return(-1);
+    run.pool = xmlNewParserCtxtPool(XML_BATCH_MAX_CTXTS);
+    group = xmlNewTaskGroup();
+    if ((run.pool == NULL) || (group == NULL)) {
+        ret = -1;
+        goto done;
+    }
+
+    for (i = 0; i < nbItems; i++) {
+        tasks[i].run = &run;
+        tasks[i].index = i;
+        tasks[i].success = 0;
+        if (xmlTaskGroupSubmit(group, xmlBatchParse, &tasks[i]) < 0)
+            xmlBatchParse(&tasks[i]);
+    }
+    xmlTaskGroupJoin(group);
+
+    for (i = 0; i < nbItems; i++)
+        ret += tasks[i].success;
+
+done:
+    xmlFreeTaskGroup(group);
+    xmlFreeParserCtxtPool(run.pool);
+    xmlFree(tasks);
+    return(ret);
+}
@@ -40,12 +40,15 @@
 #define END(ctxt) ctxt->input->end
 
 #include "private/buf.h"
+#include "private/dict.h"
 #include "private/enc.h"
 #include "private/error.h"
 #include "private/globals.h"
 #include "private/io.h"
 #include "private/memory.h"
 #include "private/parser.h"
+#include "private/threads.h"
+#include "private/trace.h"
 
 #ifndef SIZE_MAX
   #define SIZE_MAX ((size_t) -1)
@@ -146,6 +149,25 @@ xmlCtxtGetLastError(void *ctx)
         return (NULL);
     if (ctxt->lastError.code == XML_ERR_OK)
         return (NULL);
+
+    /* Format the message of a deferred error on first access. */
+    if ((ctxt->lastError.message == NULL) && (ctxt->errorRing != NULL)) {
+        xmlErrorRing *ring = ctxt->errorRing;
+
+        if (ring->count > 0) {
+            xmlErrorRecord *rec =
+                &ring->records[(ring->count - 1) % ring->size];
+
+            if ((rec->code == ctxt->lastError.code) &&
+                (rec->domain == ctxt->lastError.domain)) {
+                ctxt->lastError.message = xmlErrorRecordFormat(rec);
+                if ((ctxt->lastError.file == NULL) && (rec->file >= 0))
+                    ctxt->lastError.file = (char *) xmlStrdup(
+                            BAD_CAST (rec->strings + rec->file));
+            }
+        }
+    }
+
     return (&ctxt->lastError);
 }
 
@@ -168,6 +190,189 @@ xmlCtxtResetLastError(void *ctx)
     xmlResetError(&ctxt->lastError);
 }
 
+/**
+ * Record errors without formatting their messages.
+ *
+ * Normally, every error formats its message and copies the file
+ * name and string arguments, even if the error handler only looks
+ * at the error code. In deferred mode, errors passed to structured
+ * error handlers only contain domain, code, level, line, column,
+ * int1 and node. The message, file and string fields are NULL.
+ * The arguments of the last `size` messages are kept in a
+ * preallocated ring and only formatted when requested with
+ * #xmlCtxtGetDeferredError, #xmlCtxtGetLastError or
+ * #xmlFormatError. Strings in messages are truncated if they are
+ * very long.
+ *
+ * Errors which end up in legacy generic error handlers are still
+ * formatted immediately. This affects validation errors raised
+ * through the parser context but not schema validation.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param size  number of errors to keep or 0 to turn deferred mode off
+ * @returns 0 on success or -1 if an argument was invalid or a memory
+ * allocation failed.
+ */
+int
+xmlCtxtSetDeferredErrors(xmlParserCtxt *ctxt, int size)
+{
+    xmlErrorRing *ring;
+
+    if ((ctxt == NULL) || (size < 0))
+        return(-1);
+
+    /* The parser reports at most this number of errors and warnings. */
+    if (size > 2 * XML_MAX_ERRORS + 1)
+        size = 2 * XML_MAX_ERRORS + 1;
+
+    ring = ctxt->errorRing;
+    if (ring != NULL) {
+        xmlFree(ring->records);
+        xmlFree(ring);
+        ctxt->errorRing = NULL;
+    }
+    if (size == 0)
+        return(0);
+
+    ring = xmlMalloc(sizeof(*ring));
+    if (ring == NULL)
+        return(-1);
+    ring->records = xmlMalloc(size * sizeof(ring->records[0]));
+    if (ring->records == NULL) {
+        xmlFree(ring);
+        return(-1);
+    }
+    ring->size = size;
+    ring->count = 0;
+    ctxt->errorRing = ring;
+
+    return(0);
+}
+
+/**
+ * Get a recorded error with formatted message in deferred mode.
+ *
+ * The result must be freed with #xmlResetError.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param index  0 for the most recent error, 1 for the one before, etc.
+ * @param err  error struct to fill
+ * @returns 0 on success, 1 if there's no such error or -1 if a memory
+ * allocation failed.
+ */
+int
+xmlCtxtGetDeferredError(xmlParserCtxt *ctxt, int index, xmlError *err)
+{
+    xmlErrorRing *ring;
+
+    if ((ctxt == NULL) || (err == NULL) || (ctxt->errorRing == NULL) ||
+        (index < 0))
+        return(1);
+
+    ring = ctxt->errorRing;
+    if ((index >= ring->size) || ((unsigned long) index >= ring->count))
+        return(1);
+
+    memset(err, 0, sizeof(*err));
+    return(xmlErrorRecordToError(
+            &ring->records[(ring->count - 1 - index) % ring->size],
+            ctxt, err));
+}
+
+/**
+ * Limit the errors reported by a parser context.
+ *
+ * Every error is still counted and affects the well-formedness and
+ * validity status, but errors beyond the limits aren't passed to
+ * error handlers, which saves formatting and copying them.
+ *
+ * - `maxErrors`: stop parsing after this number of errors. Warnings
+ *   don't count.
+ * - `maxPerCode`: report at most this number of errors with the
+ *   same code.
+ * - `dedup`: report an error code only once per node type. Parser
+ *   errors without a node use node type 0.
+ *
+ * Counts are reset with each document and can be queried with
+ * #xmlCtxtGetErrorCount. Note that the parser stops counting and
+ * reporting errors after 100 errors regardless of the policy.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param maxErrors  maximum number of errors or 0 for no limit
+ * @param maxPerCode  maximum number of errors per code or 0 for no limit
+ * @param dedup  whether to report each code once per node type
+ * @returns 0 on success or -1 if an argument was invalid or a memory
+ * allocation failed.
+ */
+int
+xmlCtxtSetErrorPolicy(xmlParserCtxt *ctxt, int maxErrors, int maxPerCode,
+                      int dedup)
+{
+    xmlErrorPolicy *policy;
+    int res;
+
+    if (ctxt == NULL)
+        return(-1);
+
+    policy = ctxt->errorPolicy;
+    res = xmlErrorPolicySet(&policy, maxErrors, maxPerCode, dedup);
+    ctxt->errorPolicy = policy;
+
+    return(res);
+}
+
+/**
+ * Get the number of errors with a code raised while parsing the
+ * current or last document, including errors which weren't reported
+ * because of the error policy. Only works if an error policy was set
+ * with #xmlCtxtSetErrorPolicy.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XML parser context
+ * @param code  the error code
+ * @param nodeType  node type, 0 for errors without node or -1 for all
+ * @returns the number of errors.
+ */
+int
+xmlCtxtGetErrorCount(xmlParserCtxt *ctxt, int code, int nodeType)
+{
+    if (ctxt == NULL)
+        return(0);
+    return(xmlErrorPolicyCount(ctxt->errorPolicy, code, nodeType));
+}
+
+/**
+ * Format the message of an error raised in deferred mode.
+ *
+ * @param ctxt  an XML parser context
+ * @param err  the error
+ * @returns the message or NULL if it isn't available.
+ */
+char *
+xmlCtxtFormatDeferredError(xmlParserCtxt *ctxt, const xmlError *err)
+{
+    xmlErrorRing *ring = ctxt->errorRing;
+    xmlErrorRecord *rec;
+
+    if ((ring == NULL) || (ring->count == 0))
+        return(NULL);
+
+    /* Only the latest error can be matched reliably. */
+    rec = &ring->records[(ring->count - 1) % ring->size];
+    if ((rec->code != err->code) || (rec->domain != err->domain) ||
+        (rec->line != err->line))
+        return(NULL);
+
+    return(xmlErrorRecordFormat(rec));
+}
+
 /**
  * Handle an out-of-memory error.
  *
@@ -186,6 +391,18 @@ xmlCtxtErrMemory(xmlParserCtxt *ctxt)
         return;
     }
 
+    if (xmlMemBudgetExceeded()) {
+        xmlMemBudget *budget;
+
+        /* Report like other resource limits, without the budget */
+        budget = xmlMemBudgetSuspend();
+        xmlCtxtErr(ctxt, NULL, ctxt->html ? XML_FROM_HTML : XML_FROM_PARSER,
+                   XML_ERR_RESOURCE_LIMIT, XML_ERR_FATAL, NULL, NULL, NULL,
+                   0, "Memory budget exceeded\n");
+        xmlMemBudgetLeave(budget);
+        return;
+    }
+
     ctxt->errNo = XML_ERR_NO_MEMORY;
     ctxt->instate = XML_PARSER_EOF; /* TODO: Remove after refactoring */
     ctxt->wellFormed = 0;
@@ -348,7 +565,9 @@ xmlCtxtVErr(xmlParserCtxt *ctxt, xmlNode *node, xmlErrorDomain domain,
                 (level < XML_ERR_FATAL || ctxt->wellFormed == 0))
                 return;
 
-            if (level == XML_ERR_FATAL && ctxt->recovery == 0)
+            /* Don't resume a stopped parser */
+            if (level == XML_ERR_FATAL && ctxt->recovery == 0 &&
+                ctxt->disableSAX < 2)
                 ctxt->disableSAX = 1;
         }
 
@@ -358,6 +577,19 @@ xmlCtxtVErr(xmlParserCtxt *ctxt, xmlNode *node, xmlErrorDomain domain,
         ctxt->nbErrors += 1;
     }
 
+    if ((ctxt->errorPolicy != NULL) &&
+        (code != XML_ERR_INTERNAL_ERROR)) {
+        xmlErrorPolicy *policy = ctxt->errorPolicy;
+        int report;
+
+        report = xmlErrorPolicyCheck(policy, code,
+                                     node ? (int) node->type : 0, level);
+        if (policy->stopped)
+            ctxt->disableSAX = 2;
+        if (!report)
+            return;
+    }
+
     if (((ctxt->options & XML_PARSE_NOERROR) == 0) &&
         ((level != XML_ERR_WARNING) ||
          ((ctxt->options & XML_PARSE_NOWARNING) == 0))) {
@@ -386,15 +618,36 @@ xmlCtxtVErr(xmlParserCtxt *ctxt, xmlNode *node, xmlErrorDomain domain,
     if (ctxt->input != NULL) {
         xmlParserInputPtr input = ctxt->input;
 
+        /* The context of both inputs can be shown */
+        xmlParserInputSyncLines(input);
         if ((input->filename == NULL) &&
             (ctxt->inputNr > 1)) {
             input = ctxt->inputTab[ctxt->inputNr - 2];
+            xmlParserInputSyncLines(input);
         }
         file = input->filename;
         line = input->line;
         col = input->col;
     }
 
+    /*
+     * In deferred mode, only record the arguments unless the error
+     * goes to a legacy handler which needs the message.
+     */
+    if ((ctxt->errorRing != NULL) && (code != XML_ERR_INTERNAL_ERROR) &&
+        ((schannel != NULL) || (channel == NULL) ||
+         (xmlStructuredError != NULL))) {
+        xmlErrorRing *ring = ctxt->errorRing;
+
+        xmlErrorRecordInit(&ring->records[ring->count % ring->size],
+                           domain, code, level, file, line, col, int1,
+                           msg, ap);
+        ring->count += 1;
+        xmlRaiseDeferredError(schannel, data, ctxt, node, domain, code,
+                              level, line, int1, col, &ctxt->lastError);
+        return;
+    }
+
     res = xmlVRaiseError(schannel, channel, data, ctxt, node, domain, code,
                          level, file, line, (const char *) str1,
                          (const char *) str2, (const char *) str3, int1, col,
@@ -606,6 +859,40 @@ xmlParserInputRead(xmlParserInput *in ATTRIBUTE_UNUSED, int len ATTRIBUTE_UNUSED
     return(-1);
 }
 
+/*
+ * Number of interrupt checks between reads of the clock
+ */
+#define XML_PARSER_CLOCK_INTERVAL 64
+
+/**
+ * Stop the parser if #xmlStopParser was called from another thread
+ * or the time limit has passed. Called when reading input and at
+ * element boundaries. The clock is only read every few calls.
+ *
+ * @param ctxt  an XML parser context
+ * @returns -1 if the parser was stopped, 0 otherwise.
+ */
+int
+xmlParserCheckInterrupt(xmlParserCtxt *ctxt) {
+    if (ctxt->stopRequested) {
+        /* Make sure the error is recorded by the parsing thread. */
+        xmlStopParser(ctxt);
+        return(-1);
+    }
+
+    if ((ctxt->timeLimit != 0) &&
+        (++ctxt->interruptChecks >= XML_PARSER_CLOCK_INTERVAL)) {
+        ctxt->interruptChecks = 0;
+        if ((long) (xmlMonotonicTimeMs() - ctxt->deadline) >= 0) {
+            xmlFatalErr(ctxt, XML_ERR_RESOURCE_LIMIT,
+                        "Time limit exceeded\n");
+            return(-1);
+        }
+    }
+
+    return(0);
+}
+
 /**
  * Grow the input buffer.
  *
@@ -623,6 +910,8 @@ xmlParserGrow(xmlParserCtxt *ctxt) {
                        XML_MAX_LOOKUP_LIMIT;
     int ret;
 
+    if (PARSER_INTERRUPTED(ctxt))
+        return(-1);
     if (buf == NULL)
         return(0);
     /* Don't grow push parser buffer. */
@@ -645,6 +934,7 @@ xmlParserGrow(xmlParserCtxt *ctxt) {
 
     ret = xmlParserInputBufferGrow(buf, INPUT_CHUNK);
     xmlBufUpdateInput(buf->buffer, in, curBase);
+    ctxt->stats.inputGrows++;
 
     if (ret < 0) {
         xmlCtxtErrIO(ctxt, buf->error, NULL);
@@ -751,17 +1041,19 @@ xmlParserShrink(xmlParserCtxt *ctxt) {
     xmlParserInputBufferPtr buf = in->buf;
     size_t used, res;
 
-    if (buf == NULL)
+    if ((buf == NULL) || (in->flags & XML_INPUT_KEEP_SOURCE))
         return;
 
     used = in->cur - in->base;
 
     if (used > LINE_LEN) {
+        xmlParserInputSyncLines(in);
         res = xmlBufShrink(buf->buffer, used - LINE_LEN);
 
         if (res > 0) {
             used -= res;
             xmlSaturatedAddSizeT(&in->consumed, res);
+            ctxt->stats.inputShrinks++;
         }
 
         xmlBufUpdateInput(buf->buffer, in, used);
@@ -785,10 +1077,12 @@ xmlParserInputShrink(xmlParserInput *in) {
     if (in->base == NULL) return;
     if (in->cur == NULL) return;
     if (in->buf->buffer == NULL) return;
+    if (in->flags & XML_INPUT_KEEP_SOURCE) return;
 
     used = in->cur - in->base;
 
     if (used > LINE_LEN) {
+        xmlParserInputSyncLines(in);
 	ret = xmlBufShrink(in->buf->buffer, used - LINE_LEN);
 	if (ret > 0) {
             used -= ret;
@@ -799,6 +1093,86 @@ xmlParserInputShrink(xmlParserInput *in) {
     }
 }
 
+/**
+ * Only track byte positions in an input and compute line and column
+ * numbers on demand, see #xmlCtxtSetLazyLines. The current position
+ * becomes the first checkpoint.
+ *
+ * @param in  an XML parser input
+ */
+void
+xmlParserInputSetLazyLines(xmlParserInput *in) {
+    unsigned long pos;
+
+    if ((in == NULL) || (in->cur == NULL))
+        return;
+
+    pos = in->consumed;
+    xmlSaturatedAddSizeT(&pos, in->cur - in->base);
+
+    in->flags |= XML_INPUT_LAZY_LINES;
+    in->lineCheck = pos;
+    in->checkLine = in->line;
+    in->checkCol = in->col;
+}
+
+/**
+ * Update the line and column numbers of an input with lazy line
+ * numbers by counting line breaks between the last checkpoint and
+ * the current position, which becomes the new checkpoint.
+ *
+ * Must be called before reading the line or column numbers and
+ * before consumed input is discarded. Does nothing for other
+ * inputs.
+ *
+ * @param in  an XML parser input
+ */
+void
+xmlParserInputSyncLines(xmlParserInput *in) {
+    const xmlChar *cur, *end, *nl;
+    unsigned long pos;
+    int line, col;
+
+    if ((in == NULL) || ((in->flags & XML_INPUT_LAZY_LINES) == 0) ||
+        (in->cur == NULL))
+        return;
+
+    pos = in->consumed;
+    xmlSaturatedAddSizeT(&pos, in->cur - in->base);
+
+    line = in->checkLine;
+    col = in->checkCol;
+
+    /*
+     * If the buffer was reset without accounting for the discarded
+     * input, the checkpoint is lost. Continue from the current
+     * position in this case.
+     */
+    if ((in->lineCheck >= in->consumed) && (in->lineCheck < pos)) {
+        cur = in->base + (in->lineCheck - in->consumed);
+        end = in->cur;
+
+        while ((nl = memchr(cur, '\n', end - cur)) != NULL) {
+            line++;
+            col = 1;
+            cur = nl + 1;
+        }
+
+        /* Columns count characters, not bytes */
+        while (cur < end) {
+            if ((*cur & 0xC0) != 0x80)
+                col++;
+            cur++;
+        }
+    }
+
+    in->line = line;
+    in->col = col;
+    in->lineCheck = pos;
+    in->checkLine = line;
+    in->checkCol = col;
+}
+
 /************************************************************************
  *									*
  *		UTF8 character input and related functions		*
@@ -1413,6 +1787,7 @@ xmlInputSetEncodingHandler(xmlParserInput *input,
          * Move it as the raw buffer and create a new input buffer
          */
         processed = input->cur - input->base;
+        xmlParserInputSyncLines(input);
         xmlBufShrink(in->raw, processed);
         input->consumed += processed;
         in->rawconsumed = processed;
@@ -2003,7 +2378,9 @@ xmlCtxtNewInputFromString(xmlParserCtxt *ctxt, const char *url,
  *
  * Supported `flags` are XML_INPUT_UNZIP to decompress data
  * automatically. This feature is deprecated and will be removed
- * in a future release.
+ * in a future release. XML_INPUT_MMAP maps regular files into
+ * memory if possible. XML_INPUT_ASYNC reads regular files ahead
+ * in a separate thread.
  *
  * @since 2.14.0
  *
@@ -2050,6 +2427,10 @@ xmlCtxtNewInputFromFd(xmlParserCtxt *ctxt, const char *url,
 
     if (ctxt->options & XML_PARSE_UNZIP)
         flags |= XML_INPUT_UNZIP;
+    if (ctxt->options & XML_PARSE_MMAP)
+        flags |= XML_INPUT_MMAP;
+    if (ctxt->options & XML_PARSE_ASYNC_IO)
+        flags |= XML_INPUT_ASYNC;
 
     input = xmlNewInputFromFd(url, fd, flags);
     if (input == NULL) {
@@ -2248,6 +2629,9 @@ xmlNewEntityInputStream(xmlParserCtxt *ctxt, xmlEntity *ent) {
         return(NULL);
 
     input->entity = ent;
+    if ((ent->etype == XML_INTERNAL_GENERAL_ENTITY) ||
+        (ent->etype == XML_INTERNAL_PARAMETER_ENTITY))
+        input->flags |= XML_INPUT_INTERNAL_ENTITY;
 
     return(input);
 }
@@ -2424,6 +2808,11 @@ xmlCheckHTTPInput(xmlParserCtxt *ctxt ATTRIBUTE_UNUSED,
  *
  * The flag XML_INPUT_NETWORK allows network access.
  *
+ * The flag XML_INPUT_MMAP maps regular files into memory.
+ *
+ * The flag XML_INPUT_ASYNC reads regular files ahead in a separate
+ * thread.
+ *
  * The following resource loaders will be called if they were
  * registered (in order of precedence):
  *
@@ -2512,6 +2901,10 @@ xmlNewInputFromFile(xmlParserCtxt *ctxt, const char *filename) {
 
     if (ctxt->options & XML_PARSE_UNZIP)
         flags |= XML_INPUT_UNZIP;
+    if (ctxt->options & XML_PARSE_MMAP)
+        flags |= XML_INPUT_MMAP;
+    if (ctxt->options & XML_PARSE_ASYNC_IO)
+        flags |= XML_INPUT_ASYNC;
     if ((ctxt->options & XML_PARSE_NONET) == 0)
         flags |= XML_INPUT_NETWORK;
 
@@ -2657,9 +3050,9 @@ xmlCtxtSetResourceLoader(xmlParserCtxt *ctxt, xmlResourceLoader loader,
  * @param type  resource type
  * @returns the xmlParserInput or NULL in case of error.
  */
-xmlParserInput *
-xmlLoadResource(xmlParserCtxt *ctxt, const char *url, const char *publicId,
-                xmlResourceType type) {
+static xmlParserInputPtr
+xmlLoadResourceInternal(xmlParserCtxtPtr ctxt, const char *url,
+                        const char *publicId, xmlResourceType type) {
     char *canonicFilename;
     xmlParserInputPtr ret;
 
@@ -2680,6 +3073,10 @@ xmlLoadResource(xmlParserCtxt *ctxt, const char *url, const char *publicId,
 
         if (ctxt->options & XML_PARSE_UNZIP)
             flags |= XML_INPUT_UNZIP;
+        if (ctxt->options & XML_PARSE_MMAP)
+            flags |= XML_INPUT_MMAP;
+        if (ctxt->options & XML_PARSE_ASYNC_IO)
+            flags |= XML_INPUT_ASYNC;
         if ((ctxt->options & XML_PARSE_NONET) == 0)
             flags |= XML_INPUT_NETWORK;
 
@@ -2709,6 +3106,423 @@ xmlLoadResource(xmlParserCtxt *ctxt, const char *url, const char *publicId,
     return(ret);
 }
 
+/************************************************************************
+ *									*
+ *			Resource cache					*
+ *									*
+ ************************************************************************/
+
+/*
+ * Process-wide cache of external resources like DTDs, entities and
+ * schema documents. Entries hold the raw bytes of a resource keyed
+ * by its resolved URL and are kept in a list sorted from most to
+ * least recently used.
+ */
+typedef struct _xmlResourceCacheEntry xmlResourceCacheEntry;
+struct _xmlResourceCacheEntry {
+    xmlResourceCacheEntry *prev;
+    xmlResourceCacheEntry *next;
+    const char *url;
+    const char *variant;
+    size_t size;
+    char data[];
+};
+
+static xmlMutex xmlResourceCacheMutex;
+static xmlHashTablePtr xmlResourceCacheHash;
+static xmlResourceCacheEntry *xmlResourceCacheFirst;
+static xmlResourceCacheEntry *xmlResourceCacheLast;
+static size_t xmlResourceCacheUsed;
+static size_t xmlResourceCacheMax;
+static size_t xmlResourceCacheMaxEntry;
+
+/*
+ * Secondary key for resources loaded with XML_PARSE_UNZIP which can
+ * differ from the raw file.
+ */
+static const char xmlResourceCacheUnzip[] = "unzip";
+
+/**
+ * Initialize the resource cache.
+ */
+void
+xmlInitResourceCacheInternal(void) {
+    xmlInitMutex(&xmlResourceCacheMutex);
+}
+
+/**
+ * Unlink and free a cache entry. The cache mutex must be held.
+ *
+ * @param entry  the entry
+ */
+static void
+xmlResourceCacheRemove(xmlResourceCacheEntry *entry) {
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        xmlResourceCacheFirst = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        xmlResourceCacheLast = entry->prev;
+
+    xmlHashRemoveEntry2(xmlResourceCacheHash, BAD_CAST entry->url,
+                        BAD_CAST entry->variant, NULL);
+    xmlResourceCacheUsed -= entry->size;
+    xmlFree(entry);
+}
+
+/**
+ * Evict least recently used entries until the cache holds at most
+ * `max` bytes. The cache mutex must be held.
+ *
+ * @param max  maximum size in bytes
+ */
+static void
+xmlResourceCacheEvict(size_t max) {
+    while ((xmlResourceCacheLast != NULL) && (xmlResourceCacheUsed > max))
+        xmlResourceCacheRemove(xmlResourceCacheLast);
+}
+
+/**
+ * Free all cache entries. The cache mutex must be held.
+ */
+static void
+xmlResourceCacheReset(void) {
+    xmlResourceCacheEvict(0);
+    if (xmlResourceCacheHash != NULL) {
+        xmlHashFree(xmlResourceCacheHash, NULL);
+        xmlResourceCacheHash = NULL;
+    }
+}
+
+/**
+ * Free the resource cache.
+ */
+void
+xmlCleanupResourceCacheInternal(void) {
+    xmlResourceCacheReset();
+    xmlResourceCacheMax = 0;
+    xmlResourceCacheMaxEntry = 0;
+    xmlCleanupMutex(&xmlResourceCacheMutex);
+}
+
+/**
+ * Enable or resize the process-wide resource cache.
+ *
+ * When enabled, external DTDs, external entities, XIncluded
+ * documents and schema documents loaded with the default resource
+ * loader are kept in memory, keyed by their URL after catalog
+ * resolution. Later loads of the same URL are served from memory
+ * instead of the file system or network. The least recently used
+ * resources are evicted when the cache would exceed `maxSize` bytes.
+ * Resources larger than `maxEntrySize` bytes are never cached.
+ *
+ * The cache assumes that resources don't change while they're
+ * cached. Call #xmlResourceCacheClear after modifying them. The
+ * cache isn't used if a custom resource loader, external entity
+ * loader or input buffer callback is installed with
+ * #xmlCtxtSetResourceLoader, #xmlSetExternalEntityLoader or
+ * #xmlParserInputBufferCreateFilenameDefault.
+ *
+ * The cache is disabled by default. A `maxSize` of 0 disables the
+ * cache and frees all entries.
+ *
+ * This function is thread-safe.
+ *
+ * @since 2.16.0
+ *
+ * @param maxSize  maximum total size in bytes
+ * @param maxEntrySize  maximum size of a single resource in bytes,
+ * 0 means `maxSize`
+ */
+void
+xmlResourceCacheSetLimits(size_t maxSize, size_t maxEntrySize) {
+    xmlInitParser();
+
+    if ((maxEntrySize == 0) || (maxEntrySize > maxSize))
+        maxEntrySize = maxSize;
+
+    xmlMutexLock(&xmlResourceCacheMutex);
+    xmlResourceCacheMax = maxSize;
+    xmlResourceCacheMaxEntry = maxEntrySize;
+    if (maxSize == 0)
+        xmlResourceCacheReset();
+    else
+        xmlResourceCacheEvict(maxSize);
+    xmlMutexUnlock(&xmlResourceCacheMutex);
+}
+
+/**
+ * Free all entries of the resource cache. The size limits are
+ * unchanged.
+ *
+ * This function is thread-safe.
+ *
+ * @since 2.16.0
+ */
+void
+xmlResourceCacheClear(void) {
+    xmlInitParser();
+
+    xmlMutexLock(&xmlResourceCacheMutex);
+    xmlResourceCacheReset();
+    xmlMutexUnlock(&xmlResourceCacheMutex);
+}
+
+/**
+ * Create an input from a cached resource.
+ *
+ * @param url  the resolved URL
+ * @param variant  secondary key
+ * @param hit  set to 1 if the resource was found
+ * @returns the new input or NULL if the resource isn't cached or
+ * a memory allocation failed.
+ */
+static xmlParserInputPtr
+xmlResourceCacheLookup(const char *url, const char *variant, int *hit) {
+    xmlResourceCacheEntry *entry = NULL;
+    xmlParserInputPtr input = NULL;
+
+    *hit = 0;
+
+    xmlMutexLock(&xmlResourceCacheMutex);
+
+    if (xmlResourceCacheHash != NULL)
+        entry = xmlHashLookup2(xmlResourceCacheHash, BAD_CAST url,
+                               BAD_CAST variant);
+
+    if (entry != NULL) {
+        *hit = 1;
+
+        /* Move to front */
+        if (entry->prev != NULL) {
+            entry->prev->next = entry->next;
+            if (entry->next != NULL)
+                entry->next->prev = entry->prev;
+            else
+                xmlResourceCacheLast = entry->prev;
+            entry->prev = NULL;
+            entry->next = xmlResourceCacheFirst;
+            xmlResourceCacheFirst->prev = entry;
+            xmlResourceCacheFirst = entry;
+        }
+
+        /*
+         * The entry can be evicted while the input is in use, so
+         * the data must be copied.
+         */
+        input = xmlNewInputFromMemory(url, entry->data, entry->size, 0);
+    }
+
+    xmlMutexUnlock(&xmlResourceCacheMutex);
+
+    return(input);
+}
+
+/**
+ * Add a resource to the cache.
+ *
+ * @param url  the resolved URL
+ * @param variant  secondary key
+ * @param data  the content
+ * @param size  size of the content
+ */
+static void
+xmlResourceCacheStore(const char *url, const char *variant,
+                      const xmlChar *data, size_t size) {
+    xmlResourceCacheEntry *entry;
+    struct _xmlMemBudget *budget;
+    size_t urlSize;
+
+    /* Cache entries must not be charged to a parser's memory budget */
+    budget = xmlMemBudgetSuspend();
+
+    xmlMutexLock(&xmlResourceCacheMutex);
+
+    if (size > xmlResourceCacheMaxEntry)
+        goto done;
+
+    if (xmlResourceCacheHash == NULL) {
+        xmlResourceCacheHash = xmlHashCreate(0);
+        if (xmlResourceCacheHash == NULL)
+            goto done;
+    } else if (xmlHashLookup2(xmlResourceCacheHash, BAD_CAST url,
+                              BAD_CAST variant) != NULL) {
+        /* Stored by another thread in the meantime */
+        goto done;
+    }
+
+    xmlResourceCacheEvict(xmlResourceCacheMax - size);
+
+    urlSize = strlen(url) + 1;
+    if (size > SIZE_MAX - sizeof(*entry) - urlSize)
+        goto done;
+
+    /* The URL is stored after the data */
+    entry = xmlMalloc(sizeof(*entry) + size + urlSize);
+    if (entry == NULL)
+        goto done;
+    memcpy(entry->data, data, size);
+    memcpy(entry->data + size, url, urlSize);
+    entry->url = entry->data + size;
+    entry->variant = variant;
+    entry->size = size;
+
+    if (xmlHashAdd2(xmlResourceCacheHash, BAD_CAST url, BAD_CAST variant,
+                    entry) < 0) {
+        xmlFree(entry);
+        goto done;
+    }
+
+    entry->prev = NULL;
+    entry->next = xmlResourceCacheFirst;
+    if (xmlResourceCacheFirst != NULL)
+        xmlResourceCacheFirst->prev = entry;
+    else
+        xmlResourceCacheLast = entry;
+    xmlResourceCacheFirst = entry;
+    xmlResourceCacheUsed += size;
+
+done:
+    xmlMutexUnlock(&xmlResourceCacheMutex);
+    xmlMemBudgetLeave(budget);
+}
+
+/**
+ * Load a resource with the default loader through the resource
+ * cache. Falls back to the regular loaders if the cache is disabled
+ * or custom loaders are installed.
+ *
+ * @param ctxt  parser context
+ * @param url  the URL or system ID for the entity to load
+ * @param publicId  the public ID for the entity to load (optional)
+ * @param type  resource type
+ * @returns the xmlParserInput or NULL in case of error.
+ */
+xmlParserInput *
+xmlLoadCachedResource(xmlParserCtxt *ctxt, const char *url,
+                      const char *publicId, xmlResourceType type) {
+    xmlParserInputPtr input;
+    xmlParserInputBufferPtr buf;
+    xmlParserErrors code;
+    xmlParserInputFlags flags = 0;
+    const char *variant = NULL;
+    char *canonic, *resource = NULL;
+    size_t maxEntry;
+    int hit, res;
+
+    if ((ctxt == NULL) || (url == NULL) ||
+        (ctxt->resourceLoader != NULL) ||
+        (xmlCurrentExternalEntityLoader != xmlDefaultExternalEntityLoader) ||
+        (xmlParserInputBufferCreateFilenameValue != NULL))
+        return(xmlLoadResourceInternal(ctxt, url, publicId, type));
+
+    xmlMutexLock(&xmlResourceCacheMutex);
+    maxEntry = xmlResourceCacheMaxEntry;
+    xmlMutexUnlock(&xmlResourceCacheMutex);
+    if (maxEntry == 0)
+        return(xmlLoadResourceInternal(ctxt, url, publicId, type));
+
+    /* Resolve the URL like xmlDefaultExternalEntityLoader */
+    canonic = (char *) xmlCanonicPath((const xmlChar *) url);
+    if (canonic == NULL) {
+        xmlCtxtErrMemory(ctxt);
+        return(NULL);
+    }
+#ifdef LIBXML_CATALOG_ENABLED
+    resource = xmlCtxtResolveFromCatalog(ctxt, canonic, publicId);
+#endif
+    url = (resource != NULL) ? resource : canonic;
+
+    if ((ctxt->options & XML_PARSE_NONET) &&
+        (xmlStrncasecmp(BAD_CAST url, BAD_CAST "http://", 7) == 0)) {
+        xmlCtxtErrIO(ctxt, XML_IO_NETWORK_ATTEMPT, url);
+        input = NULL;
+        goto done;
+    }
+
+    if (ctxt->options & XML_PARSE_UNZIP) {
+        flags |= XML_INPUT_UNZIP;
+        variant = xmlResourceCacheUnzip;
+    }
+
+    input = xmlResourceCacheLookup(url, variant, &hit);
+    if (hit) {
+        if (input == NULL)
+            xmlCtxtErrMemory(ctxt);
+        goto done;
+    }
+
+    if (ctxt->options & XML_PARSE_MMAP)
+        flags |= XML_INPUT_MMAP;
+    if (ctxt->options & XML_PARSE_ASYNC_IO)
+        flags |= XML_INPUT_ASYNC;
+    if ((ctxt->options & XML_PARSE_NONET) == 0)
+        flags |= XML_INPUT_NETWORK;
+
+    code = xmlNewInputFromUrl(url, flags, &input);
+    if (code != XML_ERR_OK) {
+        xmlCtxtErrIO(ctxt, code, url);
+        goto done;
+    }
+
+    /*
+     * Read the whole resource before the encoding is detected, so
+     * the buffer contains the raw bytes. Stop once the resource is
+     * too large to be cached. Read errors are reported by the
+     * parser later.
+     */
+    buf = input->buf;
+    do {
+        if (xmlBufUse(buf->buffer) > maxEntry)
+            goto done;
+        res = xmlParserInputBufferGrow(buf, XML_IO_BUFFER_SIZE);
+    } while (res > 0);
+
+    if ((res == 0) && (buf->error == XML_ERR_OK))
+        xmlResourceCacheStore(url, variant, xmlBufContent(buf->buffer),
+                              xmlBufUse(buf->buffer));
+
+    xmlBufResetInput(buf->buffer, input);
+
+done:
+    xmlFree(canonic);
+    if (resource != NULL)
+        xmlFree(resource);
+    return(input);
+}
+
+/**
+ * @param ctxt  parser context
+ * @param url  the URL or system ID for the entity to load
+ * @param publicId  the public ID for the entity to load (optional)
+ * @param type  resource type
+ * @returns the xmlParserInput or NULL in case of error.
+ */
+xmlParserInput *
+xmlLoadResource(xmlParserCtxt *ctxt, const char *url, const char *publicId,
+                xmlResourceType type) {
+    xmlParserInputPtr input;
+    double start;
+
+    XML_TRACE_BEGIN(entity_load, 0, url, start);
+
+    /* Main documents are rarely loaded twice */
+    if (type != XML_RESOURCE_MAIN_DOCUMENT)
+        input = xmlLoadCachedResource(ctxt, url, publicId, type);
+    else
+        input = xmlLoadResourceInternal(ctxt, url, publicId, type);
+
+    /* Only the bytes available right after loading are known */
+    XML_TRACE_END(entity_load, XML_TRACE_ENTITY_LOAD, url,
+                  (input != NULL) ? (long) (input->end - input->base) : -1,
+                  start);
+
+    return(input);
+}
+
+
 /**
  * `URL` is a filename or URL. If if contains the substring "://",
  * it is assumed to be a Legacy Extended IRI. Otherwise, it is
@@ -2906,6 +3720,7 @@ xmlInitSAXParserCtxt(xmlParserCtxtPtr ctxt, const xmlSAXHandler *sax,
     ctxt->catalogs = NULL;
     ctxt->sizeentities = 0;
     ctxt->sizeentcopy = 0;
+    xmlCtxtResetStats(ctxt);
     ctxt->input_id = 1;
     ctxt->maxAmpl = XML_MAX_AMPLIFICATION_DEFAULT;
     xmlInitNodeInfoSeq(&ctxt->node_seq);
@@ -2974,6 +3789,7 @@ xmlFreeParserCtxt(xmlParserCtxt *ctxt)
     if (ctxt->dict != NULL) xmlDictFree(ctxt->dict);
     if (ctxt->nsTab != NULL) xmlFree(ctxt->nsTab);
     if (ctxt->nsdb != NULL) xmlParserNsFree(ctxt->nsdb);
+    xmlCtxtFreeSourceSpans(ctxt);
     if (ctxt->attrHash != NULL) xmlFree(ctxt->attrHash);
     if (ctxt->pushTab != NULL) xmlFree(ctxt->pushTab);
     if (ctxt->attallocs != NULL) xmlFree(ctxt->attallocs);
@@ -3019,6 +3835,18 @@ xmlFreeParserCtxt(xmlParserCtxt *ctxt)
     if (ctxt->catalogs != NULL)
 	xmlCatalogFreeLocal(ctxt->catalogs);
 #endif
+    if (ctxt->errorRing != NULL) {
+        xmlErrorRing *ring = ctxt->errorRing;
+
+        xmlFree(ring->records);
+        xmlFree(ring);
+    }
+    xmlErrorPolicyFree(ctxt->errorPolicy);
+    xmlFree(ctxt->memBudget);
+    xmlCtxtFreeFilter(ctxt);
+    xmlFree(ctxt->filterPatterns);
+    xmlCtxtFreeAttrPlans(ctxt);
+    xmlCtxtFreeEntityTemplates(ctxt);
     xmlFree(ctxt);
 }
 
@@ -3067,6 +3895,230 @@ xmlNewSAXParserCtxt(const xmlSAXHandler *sax, void *userData)
     return(ctxt);
 }
 
+/*
+ * A pool of parser contexts which keeps the memory of stacks and
+ * tables allocated by earlier parse runs.
+ */
+struct _xmlParserCtxtPool {
+    xmlMutex mutex;
+    xmlParserCtxtPtr *ctxts;
+    int nbCtxts;
+    int maxCtxts;
+};
+
+/**
+ * Create a pool of parser contexts.
+ *
+ * Parsing many small documents with fresh contexts spends a
+ * considerable amount of time allocating and growing the parser's
+ * stacks, attribute arrays and namespace tables. Contexts released
+ * into a pool retain this memory and are handed out again by
+ * #xmlParserCtxtPoolAcquire.
+ *
+ * The pool can be shared between threads.
+ *
+ * @since 2.16.0
+ *
+ * @param maxSize  maximum number of idle contexts kept in the pool
+ * @returns the new pool or NULL if a memory allocation failed.
+ */
+xmlParserCtxtPool *
+xmlNewParserCtxtPool(int maxSize) {
+    xmlParserCtxtPool *pool;
+
+    xmlInitParser();
+
+    if (maxSize < 0)
+        maxSize = 0;
+
+    pool = xmlMalloc(sizeof(*pool));
+    if (pool == NULL)
+        return(NULL);
+    memset(pool, 0, sizeof(*pool));
+
+    if (maxSize > 0) {
+        pool->ctxts = xmlMalloc(maxSize * sizeof(pool->ctxts[0]));
+        if (pool->ctxts == NULL) {
+            xmlFree(pool);
+            return(NULL);
+        }
+    }
+    pool->maxCtxts = maxSize;
+    xmlInitMutex(&pool->mutex);
+
+    return(pool);
+}
+
+/**
+ * Free a parser context pool including all idle contexts.
+ * Contexts which are still in use must be freed with
+ * #xmlFreeParserCtxt.
+ *
+ * @since 2.16.0
+ *
+ * @param pool  the pool (optional)
+ */
+void
+xmlFreeParserCtxtPool(xmlParserCtxtPool *pool) {
+    int i;
+
+    if (pool == NULL)
+        return;
+
+    for (i = 0; i < pool->nbCtxts; i++)
+        xmlFreeParserCtxt(pool->ctxts[i]);
+    xmlFree(pool->ctxts);
+    xmlCleanupMutex(&pool->mutex);
+    xmlFree(pool);
+}
+
+/**
+ * Get a parser context from a pool. If the pool is empty, a new
+ * context is created.
+ *
+ * The context is in the same state as a context returned by
+ * #xmlNewParserCtxt. It can be used with any parser API that
+ * accepts a context and must be returned with
+ * #xmlParserCtxtPoolRelease or freed with #xmlFreeParserCtxt.
+ *
+ * @since 2.16.0
+ *
+ * @param pool  the pool
+ * @returns a parser context or NULL if a memory allocation failed.
+ */
+xmlParserCtxt *
+xmlParserCtxtPoolAcquire(xmlParserCtxtPool *pool) {
+    xmlParserCtxtPtr ctxt = NULL;
+
+    if (pool == NULL)
+        return(NULL);
+
+    xmlMutexLock(&pool->mutex);
+    if (pool->nbCtxts > 0)
+        ctxt = pool->ctxts[--pool->nbCtxts];
+    xmlMutexUnlock(&pool->mutex);
+
+    if (ctxt == NULL)
+        ctxt = xmlNewParserCtxt();
+
+    return(ctxt);
+}
+
+/**
+ * Reset a parser context to its initial state, keeping the memory
+ * of stacks and tables.
+ *
+ * @param ctxt  parser context
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+static int
+xmlParserCtxtPoolReset(xmlParserCtxtPtr ctxt) {
+    xmlParserCtxt saved;
+    xmlNodePtr node, next;
+
+    xmlCtxtReset(ctxt);
+
+    /*
+     * Documents returned from earlier runs reference the dictionary.
+     * They can be used from other threads, so don't share it with
+     * future documents.
+     */
+    if (xmlDictIsShared(ctxt->dict)) {
+        xmlDictFree(ctxt->dict);
+        ctxt->dict = NULL;
+    }
+
+    for (node = ctxt->freeElems; node != NULL; node = next) {
+        next = node->next;
+        xmlFree(node);
+    }
+    ctxt->freeElems = NULL;
+    while (ctxt->freeAttrs != NULL) {
+        xmlAttrPtr attr = ctxt->freeAttrs;
+
+        ctxt->freeAttrs = attr->next;
+        xmlFree(attr);
+    }
+    xmlFree(ctxt->vctxt.nodeTab);
+    xmlFree(ctxt->lastError.message);
+    xmlFree(ctxt->lastError.file);
+    xmlFree(ctxt->lastError.str1);
+    xmlFree(ctxt->lastError.str2);
+    xmlFree(ctxt->lastError.str3);
+    xmlFree(ctxt->memBudget);
+    xmlCtxtSetDeferredErrors(ctxt, 0);
+    xmlErrorPolicyFree(ctxt->errorPolicy);
+    xmlCtxtFreeFilter(ctxt);
+    xmlFree(ctxt->filterPatterns);
+    xmlCtxtFreeAttrPlans(ctxt);
+    xmlCtxtFreeEntityTemplates(ctxt);
+
+    /*
+     * Clear everything except the retained buffers.
+     */
+    saved = *ctxt;
+    memset(ctxt, 0, sizeof(*ctxt));
+
+    ctxt->dict = saved.dict;
+    ctxt->sax = saved.sax;
+    ctxt->inputTab = saved.inputTab;
+    ctxt->inputMax = saved.inputMax;
+    ctxt->nodeTab = saved.nodeTab;
+    ctxt->nodeMax = saved.nodeMax;
+    ctxt->nameTab = saved.nameTab;
+    ctxt->nameMax = saved.nameMax;
+    ctxt->pushTab = saved.pushTab;
+    ctxt->spaceTab = saved.spaceTab;
+    ctxt->spaceMax = saved.spaceMax;
+    ctxt->nsTab = saved.nsTab;
+    ctxt->nsMax = saved.nsMax;
+    ctxt->nsdb = saved.nsdb;
+    ctxt->attallocs = saved.attallocs;
+    ctxt->attrHash = saved.attrHash;
+    ctxt->attrHashMax = saved.attrHashMax;
+    ctxt->nodeInfoTab = saved.nodeInfoTab;
+    ctxt->nodeInfoMax = saved.nodeInfoMax;
+
+    if (xmlInitSAXParserCtxt(ctxt, NULL, NULL) < 0)
+        return(-1);
+
+    /* xmlInitSAXParserCtxt doesn't expect an attribute array */
+    ctxt->atts = saved.atts;
+    ctxt->maxatts = saved.maxatts;
+
+    return(0);
+}
+
+/**
+ * Return a parser context to a pool. The context is reset and
+ * all settings like options, error handlers or SAX callbacks are
+ * cleared. Documents in ctxt->myDoc are freed. If the pool is
+ * full, the context is freed.
+ *
+ * @since 2.16.0
+ *
+ * @param pool  the pool
+ * @param ctxt  a parser context (optional)
+ */
+void
+xmlParserCtxtPoolRelease(xmlParserCtxtPool *pool, xmlParserCtxt *ctxt) {
+    if (ctxt == NULL)
+        return;
+    if ((pool == NULL) || (xmlParserCtxtPoolReset(ctxt) < 0)) {
+        xmlFreeParserCtxt(ctxt);
+        return;
+    }
+
+    xmlMutexLock(&pool->mutex);
+    if (pool->nbCtxts < pool->maxCtxts) {
+        pool->ctxts[pool->nbCtxts++] = ctxt;
+        ctxt = NULL;
+    }
+    xmlMutexUnlock(&pool->mutex);
+
+    xmlFreeParserCtxt(ctxt);
+}
+
 /**
  * @since 2.14.0
  *
@@ -3160,6 +4212,8 @@ xmlCtxtSetDict(xmlParserCtxt *ctxt, xmlDict *dict) {
 
     xmlDictReference(dict);
     ctxt->dict = dict;
+    ctxt->statsDictLookups = xmlDictGetLookups(dict);
+    ctxt->statsDictSize = (dict != NULL) ? xmlDictSize(dict) : 0;
 }
 
 /**
@@ -3423,6 +4477,7 @@ xmlCtxtGetInputPosition(xmlParserCtxt *ctxt, int inputIndex,
         return -1;
 
     input = ctxt->inputTab[inputIndex];
+    xmlParserInputSyncLines(input);
 
     if (filename != NULL)
         *filename = input->filename;
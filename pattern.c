@@ -36,6 +36,7 @@
 
 #include "private/memory.h"
 #include "private/parser.h"
+#include "private/pattern.h"
 
 #ifdef LIBXML_PATTERN_ENABLED
 
@@ -131,7 +132,9 @@ typedef enum {
     XML_OP_PARENT,
     XML_OP_ANCESTOR,
     XML_OP_NS,
-    XML_OP_ALL
+    XML_OP_ALL,
+    XML_OP_ATTR_VALUE,
+    XML_OP_FIRST
 } xmlPatOp;
 
 
@@ -156,6 +159,7 @@ struct _xmlStepOp {
     xmlPatOp op;
     const xmlChar *value;
     const xmlChar *value2; /* The namespace name */
+    const xmlChar *value3; /* The attribute value of a predicate */
 };
 
 #define PAT_FROM_ROOT	(1<<8)
@@ -242,6 +246,8 @@ xmlFreePatternInternal(xmlPatternPtr comp) {
 		    xmlFree((xmlChar *) op->value);
 		if (op->value2 != NULL)
 		    xmlFree((xmlChar *) op->value2);
+		if (op->value3 != NULL)
+		    xmlFree((xmlChar *) op->value3);
 	    }
 	}
 	xmlFree(comp->steps);
@@ -363,6 +369,7 @@ xmlPatternAdd(xmlPatParserContextPtr ctxt, xmlPatternPtr comp,
     comp->steps[comp->nbStep].op = op;
     comp->steps[comp->nbStep].value = value;
     comp->steps[comp->nbStep].value2 = value2;
+    comp->steps[comp->nbStep].value3 = NULL;
     comp->nbStep++;
     return(0);
 }
@@ -384,6 +391,7 @@ xmlReversePattern(xmlPatternPtr comp) {
         for (i = 0, j = 1;j < comp->nbStep;i++,j++) {
 	    comp->steps[i].value = comp->steps[j].value;
 	    comp->steps[i].value2 = comp->steps[j].value2;
+	    comp->steps[i].value3 = comp->steps[j].value3;
 	    comp->steps[i].op = comp->steps[j].op;
 	}
 	comp->nbStep--;
@@ -408,6 +416,9 @@ xmlReversePattern(xmlPatternPtr comp) {
 	tmp = comp->steps[i].value2;
 	comp->steps[i].value2 = comp->steps[j].value2;
 	comp->steps[j].value2 = tmp;
+	tmp = comp->steps[i].value3;
+	comp->steps[i].value3 = comp->steps[j].value3;
+	comp->steps[j].value3 = tmp;
 	op = comp->steps[i].op;
 	comp->steps[i].op = comp->steps[j].op;
 	comp->steps[j].op = op;
@@ -417,6 +428,7 @@ xmlReversePattern(xmlPatternPtr comp) {
 
     comp->steps[comp->nbStep].value = NULL;
     comp->steps[comp->nbStep].value2 = NULL;
+    comp->steps[comp->nbStep].value3 = NULL;
     comp->steps[comp->nbStep++].op = XML_OP_END;
     return(0);
 }
@@ -448,6 +460,85 @@ xmlPatPushState(xmlStepStates *states, int step, xmlNodePtr node) {
     return(0);
 }
 
+/*
+ * Check whether an element has an attribute matching a predicate.
+ * Returns 1 if it does, 0 if not and -1 if a memory allocation failed.
+ */
+static int
+xmlPatMatchAttrValue(xmlStepOpPtr step, xmlNodePtr node) {
+    xmlAttrPtr attr;
+
+    for (attr = node->properties; attr != NULL; attr = attr->next) {
+        xmlNodePtr text = attr->children;
+        xmlChar *content;
+        int equal;
+
+        if (step->value != NULL) {
+            if (!xmlStrEqual(step->value, attr->name))
+                continue;
+            /* An unprefixed name only matches attributes without namespace */
+            if ((step->value2 == NULL) && (attr->ns != NULL))
+                continue;
+        }
+        if (step->value2 != NULL) {
+            if ((attr->ns == NULL) ||
+                (!xmlStrEqual(step->value2, attr->ns->href)))
+                continue;
+        }
+        if (step->value3 == NULL)
+            return(1);
+
+        if ((text != NULL) && (text->next == NULL) &&
+            (text->type == XML_TEXT_NODE)) {
+            if (xmlStrEqual(step->value3, text->content))
+                return(1);
+            continue;
+        }
+        if (text == NULL) {
+            if (step->value3[0] == 0)
+                return(1);
+            continue;
+        }
+
+        content = xmlNodeGetContent((xmlNodePtr) attr);
+        if (content == NULL)
+            return(-1);
+        equal = xmlStrEqual(step->value3, content);
+        xmlFree(content);
+        if (equal)
+            return(1);
+    }
+
+    return(0);
+}
+
+/*
+ * Check whether an element is the first sibling matching the name
+ * test of its step.
+ */
+static int
+xmlPatMatchFirst(xmlStepOpPtr step, xmlNodePtr node) {
+    xmlNodePtr sib;
+
+    for (sib = node->prev; sib != NULL; sib = sib->prev) {
+        if (sib->type != XML_ELEMENT_NODE)
+            continue;
+        if (step->value == NULL)
+            return(0);
+        if (!xmlStrEqual(step->value, sib->name))
+            continue;
+        if (sib->ns == NULL) {
+            if (step->value2 == NULL)
+                return(0);
+        } else if ((step->value2 != NULL) &&
+                   (xmlStrEqual(step->value2, sib->ns->href))) {
+            return(0);
+        }
+    }
+
+    return(1);
+}
+
 /**
  * Test whether the node matches the pattern
  *
@@ -627,6 +718,25 @@ restart:
 		if (node->type != XML_ELEMENT_NODE)
 		    goto rollback;
 		break;
+            case XML_OP_ATTR_VALUE: {
+                int res;
+
+		if (node->type != XML_ELEMENT_NODE)
+		    goto rollback;
+                res = xmlPatMatchAttrValue(step, node);
+                if (res < 0) {
+                    xmlFree(states.states);
+                    return(-1);
+                }
+                if (res == 0)
+                    goto rollback;
+		continue;
+            }
+            case XML_OP_FIRST:
+		if ((node->type != XML_ELEMENT_NODE) ||
+                    (!xmlPatMatchFirst(step, node)))
+		    goto rollback;
+		continue;
 	}
     }
 found:
@@ -1042,6 +1152,137 @@ error:
 	XML_PAT_FREE_STRING(ctxt, name)
 }
 
+/**
+ * Compile the predicates following an element step. The predicate
+ * ops are moved before the step, so that they are checked after its
+ * name test once the pattern is reversed.
+ *
+ * [6]    Predicate    ::=    '[' ( '@' NameTest ( '=' Literal )? | '1' ) ']'
+ *
+ * @param ctxt  the compilation context
+ */
+static void
+xmlCompilePredicates(xmlPatParserContextPtr ctxt) {
+    xmlPatternPtr comp = ctxt->comp;
+    xmlChar *name = NULL;
+    xmlChar *URL = NULL;
+    xmlStepOp step;
+    int first;
+
+    SKIP_BLANKS;
+    if (CUR != '[')
+        return;
+
+    first = comp->nbStep - 1;
+    if ((first < 0) ||
+        ((comp->steps[first].op != XML_OP_ALL) &&
+         (comp->steps[first].op != XML_OP_NS) &&
+         ((comp->steps[first].op != XML_OP_ELEM) ||
+          (comp->steps[first].value == NULL)))) {
+	ERROR5(NULL, NULL, NULL,
+	    "Unexpected predicate in '%s'.\n", ctxt->base);
+        ctxt->error = 1;
+        return;
+    }
+    step = comp->steps[first];
+
+    while (CUR == '[') {
+	NEXT;
+	SKIP_BLANKS;
+	if (CUR == '@') {
+	    NEXT;
+	    xmlCompileAttributeTest(ctxt);
+	    if (ctxt->error != 0)
+		return;
+	    comp->steps[comp->nbStep - 1].op = XML_OP_ATTR_VALUE;
+	    SKIP_BLANKS;
+	    if (CUR == '=') {
+		const xmlChar *q;
+		xmlChar quote;
+		xmlChar *value;
+
+		NEXT;
+		SKIP_BLANKS;
+		quote = CUR;
+		if ((quote != '"') && (quote != '\'')) {
+		    ERROR(NULL, NULL, NULL,
+			"xmlCompilePredicates : Literal expected\n");
+		    ctxt->error = 1;
+		    return;
+		}
+		NEXT;
+		q = CUR_PTR;
+		while ((CUR != 0) && (CUR != quote))
+		    NEXT;
+		if (CUR != quote) {
+		    ERROR(NULL, NULL, NULL,
+			"xmlCompilePredicates : Unfinished literal\n");
+		    ctxt->error = 1;
+		    return;
+		}
+		if (ctxt->dict)
+		    value = (xmlChar *) xmlDictLookup(ctxt->dict, q,
+                                                      CUR_PTR - q);
+		else
+		    value = xmlStrndup(q, CUR_PTR - q);
+		if (value == NULL) {
+		    ctxt->error = -1;
+		    return;
+		}
+		comp->steps[comp->nbStep - 1].value3 = value;
+		NEXT;
+		SKIP_BLANKS;
+	    }
+	} else if ((CUR == '1') && (step.op != XML_OP_NS) &&
+                   (comp->nbStep - 1 == first)) {
+	    /* Only supported directly after the name test */
+	    NEXT;
+	    SKIP_BLANKS;
+	    if (step.value != NULL) {
+		XML_PAT_COPY_NSNAME(ctxt, name, step.value);
+		if (name == NULL) {
+		    ctxt->error = -1;
+		    return;
+		}
+	    }
+	    if (step.value2 != NULL) {
+		XML_PAT_COPY_NSNAME(ctxt, URL, step.value2);
+		if (URL == NULL) {
+		    ctxt->error = -1;
+		    goto error;
+		}
+	    }
+	    PUSH(XML_OP_FIRST, name, URL);
+	    name = NULL;
+	    URL = NULL;
+	} else {
+	    ERROR5(NULL, NULL, NULL,
+		"Unsupported predicate in '%s'.\n", ctxt->base);
+	    ctxt->error = 1;
+	    return;
+	}
+	if (CUR != ']') {
+	    ERROR(NULL, NULL, NULL,
+		"xmlCompilePredicates : ']' expected\n");
+	    ctxt->error = 1;
+	    return;
+	}
+	NEXT;
+	SKIP_BLANKS;
+    }
+
+    /* Move the step after its predicates. */
+    memmove(&comp->steps[first], &comp->steps[first + 1],
+            (comp->nbStep - first - 1) * sizeof(step));
+    comp->steps[comp->nbStep - 1] = step;
+    return;
+error:
+    if (name != NULL)
+	XML_PAT_FREE_STRING(ctxt, name)
+    if (URL != NULL)
+	XML_PAT_FREE_STRING(ctxt, URL)
+}
+
 /**
  * Compile the Path Pattern and generates a precompiled
  * form suitable for fast matching.
@@ -1103,6 +1344,9 @@ xmlCompilePathPattern(xmlPatParserContextPtr ctxt) {
 	    }
 	}
 	xmlCompileStepPattern(ctxt);
+	if (ctxt->error != 0)
+	    goto error;
+	xmlCompilePredicates(ctxt);
 	if (ctxt->error != 0)
 	    goto error;
 	SKIP_BLANKS;
@@ -1115,6 +1359,9 @@ xmlCompilePathPattern(xmlPatParserContextPtr ctxt) {
 		xmlCompileStepPattern(ctxt);
 		if (ctxt->error != 0)
 		    goto error;
+		xmlCompilePredicates(ctxt);
+		if (ctxt->error != 0)
+		    goto error;
 	    } else {
 	        PUSH(XML_OP_PARENT, NULL, NULL);
 		NEXT;
@@ -1128,6 +1375,9 @@ xmlCompilePathPattern(xmlPatParserContextPtr ctxt) {
 		xmlCompileStepPattern(ctxt);
 		if (ctxt->error != 0)
 		    goto error;
+		xmlCompilePredicates(ctxt);
+		if (ctxt->error != 0)
+		    goto error;
 	    }
 	}
     }
@@ -1472,6 +1722,10 @@ xmlStreamCompile(xmlPatternPtr comp) {
 		prevs = s;
 		flags = 0;
 		break;
+	    case XML_OP_ATTR_VALUE:
+	    case XML_OP_FIRST:
+		/* Predicates can't be evaluated when streaming. */
+		goto error;
 	    case XML_OP_PARENT:
 	        break;
 	    case XML_OP_ANCESTOR:
@@ -2231,6 +2485,42 @@ xmlPatternMatch(xmlPattern *comp, xmlNode *node)
     return(ret);
 }
 
+/**
+ * Get the names of the elements a pattern can match. Nodes with
+ * other names never match and can be skipped without calling
+ * #xmlPatternMatch.
+ *
+ * @param comp  the precompiled pattern
+ * @param names  array receiving the names
+ * @param max  size of the array
+ * @returns the number of names, or -1 if the pattern can match
+ * other nodes or more than `max` names.
+ */
+int
+xmlPatternGetElementNames(xmlPattern *comp, const xmlChar **names,
+                          int max) {
+    int nb = 0;
+
+    if (comp == NULL)
+        return(-1);
+
+    while (comp != NULL) {
+        xmlStepOpPtr step = comp->steps;
+
+        /* Skip the predicates of the last step */
+        while ((step->op == XML_OP_ATTR_VALUE) ||
+               (step->op == XML_OP_FIRST))
+            step++;
+        if ((step->op != XML_OP_ELEM) || (step->value == NULL) ||
+            (nb >= max))
+            return(-1);
+        names[nb++] = step->value;
+        comp = comp->next;
+    }
+
+    return(nb);
+}
+
 /**
  * Get a streaming context for that pattern
  * Use #xmlFreeStreamCtxt to free the context.
@@ -2356,4 +2646,585 @@ xmlPatternFromRoot(xmlPattern *comp) {
 
 }
 
+
+/************************************************************************
+ *									*
+ *			Pattern sets					*
+ *									*
+ ************************************************************************/
+
+/*
+ * A pattern set merges the streaming steps of many patterns into a
+ * single automaton. Steps shared by several patterns (same axis, name
+ * and namespace after the same prefix) are merged into one trie node,
+ * so a stream of many patterns with common prefixes costs about as
+ * much as a single one. The automaton is evaluated like an NFA: every
+ * level keeps the set of trie nodes which may be extended by the next
+ * element, nodes with "//" edges stay active for all descendants.
+ */
+
+typedef struct {
+    int from;			/* source node */
+    int to;			/* target node */
+    int desc;			/* "//" edge */
+    const xmlChar *name;	/* local name, NULL for any */
+    const xmlChar *ns;		/* namespace name */
+    int nextWild;		/* next wildcard edge of the source node */
+} xmlPatSetEdge;
+
+typedef struct {
+    int nbOut;			/* number of outgoing edges */
+    int hasDesc;		/* whether an outgoing edge is "//" */
+    int firstWild;		/* first outgoing wildcard edge or -1 */
+    int firstFinal;		/* first pattern ending here or -1 */
+} xmlPatSetNode;
+
+struct _xmlPatternSet {
+    xmlDictPtr dict;		/* names and namespaces of all steps */
+    xmlPatSetNode *nodes;
+    int nbNodes;
+    int maxNodes;
+    xmlPatSetEdge *edges;
+    int nbEdges;
+    int maxEdges;
+    int *finals;		/* pairs of pattern ID and next index */
+    int nbFinals;
+    int maxFinals;
+    int *table;			/* named edges hashed by node and name */
+    int tableSize;
+};
+
+struct _xmlPatternSetStream {
+    xmlPatternSetPtr set;
+    int *entries;		/* active nodes, node * 2 + "//" only */
+    int nbEntries;
+    int maxEntries;
+    int *levels;		/* first entry of each level */
+    int nbLevels;
+    int maxLevels;
+    unsigned *marks;		/* per node and entry kind, last push seen */
+    int nbMarks;
+    unsigned gen;
+    int *matches;		/* pattern IDs matched by the last push */
+    int nbMatches;
+    int maxMatches;
+};
+
+static int
+xmlPatSetGrow(void **array, int *max, size_t elemSize) {
+    void *tmp;
+    int newSize;
+
+    newSize = xmlGrowCapacity(*max, elemSize, 8, XML_MAX_ITEMS);
+    if (newSize < 0)
+        return(-1);
+    tmp = xmlRealloc(*array, newSize * elemSize);
+    if (tmp == NULL)
+        return(-1);
+    *array = tmp;
+    *max = newSize;
+    return(0);
+}
+
+static unsigned
+xmlPatSetHash(int from, const xmlChar *name) {
+    unsigned h;
+
+    h = (unsigned) ((size_t) name >> 3) ^ ((unsigned) from * 0x9E3779B1u);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return(h);
+}
+
+static int
+xmlPatSetNewNode(xmlPatternSetPtr set) {
+    xmlPatSetNode *node;
+
+    if ((set->nbNodes >= set->maxNodes) &&
+        (xmlPatSetGrow((void **) &set->nodes, &set->maxNodes,
+                       sizeof(set->nodes[0])) < 0))
+        return(-1);
+    node = &set->nodes[set->nbNodes];
+    node->nbOut = 0;
+    node->hasDesc = 0;
+    node->firstWild = -1;
+    node->firstFinal = -1;
+    return(set->nbNodes++);
+}
+
+static int
+xmlPatSetGrowTable(xmlPatternSetPtr set) {
+    int *table;
+    int size, i;
+
+    size = set->tableSize ? set->tableSize * 2 : 64;
+    if (size > XML_MAX_ITEMS)
+        return(-1);
+    table = xmlMalloc(size * sizeof(table[0]));
+    if (table == NULL)
+        return(-1);
+    memset(table, 0, size * sizeof(table[0]));
+    for (i = 0; i < set->nbEdges; i++) {
+        xmlPatSetEdge *edge = &set->edges[i];
+        unsigned slot;
+
+        if (edge->name == NULL)
+            continue;
+        slot = xmlPatSetHash(edge->from, edge->name) & (size - 1);
+        while (table[slot] != 0)
+            slot = (slot + 1) & (size - 1);
+        table[slot] = i + 1;
+    }
+    xmlFree(set->table);
+    set->table = table;
+    set->tableSize = size;
+    return(0);
+}
+
+/*
+ * Returns the target of the edge leaving @from for this step,
+ * creating it if needed, or -1 in case of error.
+ */
+static int
+xmlPatSetStep(xmlPatternSetPtr set, int from, int desc,
+              const xmlChar *name, const xmlChar *ns) {
+    xmlPatSetEdge *edge;
+    int e, to;
+
+    if (name == NULL) {
+        for (e = set->nodes[from].firstWild; e >= 0;
+             e = set->edges[e].nextWild) {
+            edge = &set->edges[e];
+            if ((edge->desc == desc) && (edge->ns == ns))
+                return(edge->to);
+        }
+    } else if (set->tableSize > 0) {
+        unsigned mask = set->tableSize - 1;
+        unsigned slot = xmlPatSetHash(from, name) & mask;
+
+        while ((e = set->table[slot]) != 0) {
+            edge = &set->edges[e - 1];
+            if ((edge->from == from) && (edge->desc == desc) &&
+                (edge->name == name) && (edge->ns == ns))
+                return(edge->to);
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    if ((name != NULL) &&
+        ((set->nbEdges + 1) * 2 > set->tableSize) &&
+        (xmlPatSetGrowTable(set) < 0))
+        return(-1);
+    if ((set->nbEdges >= set->maxEdges) &&
+        (xmlPatSetGrow((void **) &set->edges, &set->maxEdges,
+                       sizeof(set->edges[0])) < 0))
+        return(-1);
+    to = xmlPatSetNewNode(set);
+    if (to < 0)
+        return(-1);
+
+    e = set->nbEdges++;
+    edge = &set->edges[e];
+    edge->from = from;
+    edge->to = to;
+    edge->desc = desc;
+    edge->name = name;
+    edge->ns = ns;
+    edge->nextWild = -1;
+    if (name == NULL) {
+        edge->nextWild = set->nodes[from].firstWild;
+        set->nodes[from].firstWild = e;
+    } else {
+        unsigned mask = set->tableSize - 1;
+        unsigned slot = xmlPatSetHash(from, name) & mask;
+
+        while (set->table[slot] != 0)
+            slot = (slot + 1) & mask;
+        set->table[slot] = e + 1;
+    }
+    set->nodes[from].nbOut++;
+    if (desc)
+        set->nodes[from].hasDesc = 1;
+    return(to);
+}
+
+static int
+xmlPatSetAddFinal(xmlPatternSetPtr set, int node, int id) {
+    int f;
+
+    for (f = set->nodes[node].firstFinal; f >= 0; f = set->finals[f + 1])
+        if (set->finals[f] == id)
+            return(0);
+    if ((set->nbFinals + 2 > set->maxFinals) &&
+        (xmlPatSetGrow((void **) &set->finals, &set->maxFinals,
+                       sizeof(set->finals[0]) * 2) < 0))
+        return(-1);
+    f = set->nbFinals;
+    set->finals[f] = id;
+    set->finals[f + 1] = set->nodes[node].firstFinal;
+    set->nodes[node].firstFinal = f;
+    set->nbFinals += 2;
+    return(0);
+}
+
+/**
+ * Create an empty pattern set. Use #xmlPatternSetAdd to add
+ * patterns and #xmlPatternSetGetStreamCtxt to match all of them
+ * against a stream of elements at once.
+ *
+ * @since 2.16.0
+ *
+ * @returns the new set or NULL if a memory allocation failed
+ */
+xmlPatternSet *
+xmlNewPatternSet(void) {
+    xmlPatternSetPtr set;
+
+    set = xmlMalloc(sizeof(*set));
+    if (set == NULL)
+        return(NULL);
+    memset(set, 0, sizeof(*set));
+    set->dict = xmlDictCreate();
+    if ((set->dict == NULL) || (xmlPatSetNewNode(set) < 0)) {
+        xmlFreePatternSet(set);
+        return(NULL);
+    }
+    return(set);
+}
+
+/**
+ * Free a pattern set. Stream contexts created from the set must
+ * be freed first.
+ *
+ * @since 2.16.0
+ *
+ * @param set  the pattern set
+ */
+void
+xmlFreePatternSet(xmlPatternSet *set) {
+    if (set == NULL)
+        return;
+    xmlDictFree(set->dict);
+    xmlFree(set->nodes);
+    xmlFree(set->edges);
+    xmlFree(set->finals);
+    xmlFree(set->table);
+    xmlFree(set);
+}
+
+/**
+ * Add a compiled pattern to the set. Matches of all alternatives
+ * of the pattern are reported with @id. The pattern isn't
+ * referenced by the set and can be freed afterwards.
+ *
+ * Only streamable patterns compiled with #XML_PATTERN_DEFAULT
+ * which select elements are supported. Patterns must not be added
+ * while stream contexts of the set are in use.
+ *
+ * @since 2.16.0
+ *
+ * @param set  the pattern set
+ * @param comp  the precompiled pattern
+ * @param id  the ID reported for matches of the pattern
+ * @returns 0 on success, -1 if the pattern isn't supported or in
+ *         case of error
+ */
+int
+xmlPatternSetAdd(xmlPatternSet *set, xmlPattern *comp, int id) {
+    xmlPatternPtr cur;
+    int i;
+
+    if ((set == NULL) || (comp == NULL))
+        return(-1);
+
+    for (cur = comp; cur != NULL; cur = cur->next) {
+        xmlStreamCompPtr stream = cur->stream;
+
+        if ((stream == NULL) || (stream->nbStep <= 0) ||
+            (cur->flags & XML_PATTERN_NOTPATTERN))
+            return(-1);
+        for (i = 0; i < stream->nbStep; i++) {
+            if ((stream->steps[i].nodeType != XML_ELEMENT_NODE) ||
+                (stream->steps[i].flags & (XML_STREAM_STEP_ATTR |
+                                           XML_STREAM_STEP_NODE |
+                                           XML_STREAM_STEP_IN_SET)))
+                return(-1);
+        }
+    }
+
+    for (cur = comp; cur != NULL; cur = cur->next) {
+        xmlStreamCompPtr stream = cur->stream;
+        int node = 0;
+
+        for (i = 0; i < stream->nbStep; i++) {
+            xmlStreamStepPtr step = &stream->steps[i];
+            const xmlChar *name = NULL, *ns = NULL;
+
+            if (step->name != NULL) {
+                name = xmlDictLookup(set->dict, step->name, -1);
+                if (name == NULL)
+                    return(-1);
+            }
+            if (step->ns != NULL) {
+                ns = xmlDictLookup(set->dict, step->ns, -1);
+                if (ns == NULL)
+                    return(-1);
+            }
+            node = xmlPatSetStep(set, node,
+                                 (step->flags & XML_STREAM_STEP_DESC) != 0,
+                                 name, ns);
+            if (node < 0)
+                return(-1);
+        }
+        if (xmlPatSetAddFinal(set, node, id) < 0)
+            return(-1);
+    }
+
+    return(0);
+}
+
+static void
+xmlPatSetStreamReset(xmlPatternSetStreamPtr stream) {
+    stream->nbEntries = 1;
+    stream->entries[0] = 0;
+    stream->nbLevels = 1;
+    stream->levels[0] = 0;
+    stream->nbMatches = 0;
+}
+
+/**
+ * Get a streaming context matching all patterns of the set.
+ * Use #xmlFreePatternSetStream to free the context.
+ *
+ * @since 2.16.0
+ *
+ * @param set  the pattern set
+ * @returns a pointer to the context or NULL in case of failure
+ */
+xmlPatternSetStream *
+xmlPatternSetGetStreamCtxt(xmlPatternSet *set) {
+    xmlPatternSetStreamPtr stream;
+
+    if (set == NULL)
+        return(NULL);
+    stream = xmlMalloc(sizeof(*stream));
+    if (stream == NULL)
+        return(NULL);
+    memset(stream, 0, sizeof(*stream));
+    stream->set = set;
+    if ((xmlPatSetGrow((void **) &stream->entries, &stream->maxEntries,
+                       sizeof(stream->entries[0])) < 0) ||
+        (xmlPatSetGrow((void **) &stream->levels, &stream->maxLevels,
+                       sizeof(stream->levels[0])) < 0)) {
+        xmlFreePatternSetStream(stream);
+        return(NULL);
+    }
+    xmlPatSetStreamReset(stream);
+    return(stream);
+}
+
+/**
+ * Free a stream context of a pattern set.
+ *
+ * @since 2.16.0
+ *
+ * @param stream  the stream context
+ */
+void
+xmlFreePatternSetStream(xmlPatternSetStream *stream) {
+    if (stream == NULL)
+        return;
+    xmlFree(stream->entries);
+    xmlFree(stream->levels);
+    xmlFree(stream->marks);
+    xmlFree(stream->matches);
+    xmlFree(stream);
+}
+
+static int
+xmlPatSetStreamAdd(xmlPatternSetStreamPtr stream, int node, int descOnly) {
+    unsigned *marks = stream->marks;
+
+    if ((marks[node * 2] == stream->gen) ||
+        (marks[node * 2 + descOnly] == stream->gen))
+        return(0);
+    marks[node * 2 + descOnly] = stream->gen;
+    if ((stream->nbEntries >= stream->maxEntries) &&
+        (xmlPatSetGrow((void **) &stream->entries, &stream->maxEntries,
+                       sizeof(stream->entries[0])) < 0))
+        return(-1);
+    stream->entries[stream->nbEntries++] = node * 2 + descOnly;
+    return(0);
+}
+
+static int
+xmlPatSetStreamTake(xmlPatternSetStreamPtr stream, const xmlPatSetEdge *edge) {
+    const xmlPatternSet *set = stream->set;
+    const xmlPatSetNode *to = &set->nodes[edge->to];
+    int f;
+
+    for (f = to->firstFinal; f >= 0; f = set->finals[f + 1]) {
+        if ((stream->nbMatches >= stream->maxMatches) &&
+            (xmlPatSetGrow((void **) &stream->matches, &stream->maxMatches,
+                           sizeof(stream->matches[0])) < 0))
+            return(-1);
+        stream->matches[stream->nbMatches++] = set->finals[f];
+    }
+    if (to->nbOut > 0)
+        return(xmlPatSetStreamAdd(stream, edge->to, 0));
+    return(0);
+}
+
+/**
+ * Push a new element onto the stream and report the IDs of all
+ * patterns of the set matching it. Pushing a NULL name and
+ * namespace resets the stream to the document node.
+ *
+ * @since 2.16.0
+ *
+ * @param stream  the stream context
+ * @param name  the local name of the element
+ * @param ns  the namespace name of the element or NULL
+ * @param ids  return location for the matching pattern IDs, sorted
+ *         and valid until the next push (optional)
+ * @returns the number of matching patterns or -1 in case of error
+ */
+int
+xmlPatternSetPush(xmlPatternSetStream *stream, const xmlChar *name,
+                  const xmlChar *ns, const int **ids) {
+    const xmlPatternSet *set;
+    const xmlChar *nameKey = NULL, *nsKey = NULL;
+    int start, end, i, j;
+
+    if (ids != NULL)
+        *ids = NULL;
+    if (stream == NULL)
+        return(-1);
+    set = stream->set;
+    if ((name == NULL) && (ns == NULL)) {
+        xmlPatSetStreamReset(stream);
+        return(0);
+    }
+
+    if (stream->nbMarks < set->nbNodes * 2) {
+        unsigned *marks;
+
+        marks = xmlRealloc(stream->marks,
+                           set->maxNodes * 2 * sizeof(marks[0]));
+        if (marks == NULL)
+            return(-1);
+        memset(marks, 0, set->maxNodes * 2 * sizeof(marks[0]));
+        stream->marks = marks;
+        stream->nbMarks = set->maxNodes * 2;
+        stream->gen = 0;
+    }
+    stream->gen++;
+    if (stream->gen == 0) {
+        memset(stream->marks, 0, stream->nbMarks * sizeof(unsigned));
+        stream->gen = 1;
+    }
+    if ((stream->nbLevels >= stream->maxLevels) &&
+        (xmlPatSetGrow((void **) &stream->levels, &stream->maxLevels,
+                       sizeof(stream->levels[0])) < 0))
+        return(-1);
+
+    /* Names unknown to the set can only match wildcards. */
+    if (ns != NULL)
+        nsKey = xmlDictExists(set->dict, ns, -1);
+    if ((name != NULL) && ((ns == NULL) || (nsKey != NULL)))
+        nameKey = xmlDictExists(set->dict, name, -1);
+
+    stream->nbMatches = 0;
+    start = stream->levels[stream->nbLevels - 1];
+    end = stream->nbEntries;
+    for (i = start; i < end; i++) {
+        int node = stream->entries[i] >> 1;
+        int descOnly = stream->entries[i] & 1;
+        const xmlPatSetNode *cur = &set->nodes[node];
+        const xmlPatSetEdge *edge;
+        int e;
+
+        if ((nameKey != NULL) && (set->tableSize > 0)) {
+            unsigned mask = set->tableSize - 1;
+            unsigned slot = xmlPatSetHash(node, nameKey) & mask;
+
+            while ((e = set->table[slot]) != 0) {
+                edge = &set->edges[e - 1];
+                if ((edge->from == node) && (edge->name == nameKey) &&
+                    (edge->ns == nsKey) && ((!descOnly) || (edge->desc)) &&
+                    (xmlPatSetStreamTake(stream, edge) < 0))
+                    return(-1);
+                slot = (slot + 1) & mask;
+            }
+        }
+        for (e = cur->firstWild; e >= 0; e = edge->nextWild) {
+            edge = &set->edges[e];
+            if ((descOnly) && (!edge->desc))
+                continue;
+            if ((edge->ns != NULL) && ((ns == NULL) || (edge->ns != nsKey)))
+                continue;
+            if (xmlPatSetStreamTake(stream, edge) < 0)
+                return(-1);
+        }
+        if ((cur->hasDesc) && (xmlPatSetStreamAdd(stream, node, 1) < 0))
+            return(-1);
+    }
+    stream->levels[stream->nbLevels++] = end;
+
+    /* Sort and remove duplicates, usually there are very few matches. */
+    for (i = 1; i < stream->nbMatches; i++) {
+        int id = stream->matches[i];
+
+        for (j = i; (j > 0) && (stream->matches[j - 1] > id); j--)
+            stream->matches[j] = stream->matches[j - 1];
+        stream->matches[j] = id;
+    }
+    for (i = 1, j = 1; i < stream->nbMatches; i++) {
+        if (stream->matches[i] != stream->matches[j - 1])
+            stream->matches[j++] = stream->matches[i];
+    }
+    if (stream->nbMatches > 1)
+        stream->nbMatches = j;
+
+    if (ids != NULL)
+        *ids = stream->matches;
+    return(stream->nbMatches);
+}
+
+/**
+ * Pop an element from the stream.
+ *
+ * @since 2.16.0
+ *
+ * @param stream  the stream context
+ * @returns 0 on success, -1 if the stream is at the document node
+ *         or in case of error
+ */
+int
+xmlPatternSetPop(xmlPatternSetStream *stream) {
+    if ((stream == NULL) || (stream->nbLevels <= 1))
+        return(-1);
+    stream->nbLevels--;
+    stream->nbEntries = stream->levels[stream->nbLevels];
+    return(0);
+}
+
+/**
+ * Check whether descendants of the last pushed element, or the root
+ * element after a reset, can match a pattern of the set. If not,
+ * the subtree can be skipped without pushing its elements.
+ *
+ * @since 2.16.0
+ *
+ * @param stream  the stream context
+ * @returns 1 if descendants may match, 0 if not, -1 in case of error
+ */
+int
+xmlPatternSetWantsDescendants(xmlPatternSetStream *stream) {
+    if (stream == NULL)
+        return(-1);
+    return(stream->nbEntries > stream->levels[stream->nbLevels - 1]);
+}
+
 #endif /* LIBXML_PATTERN_ENABLED */
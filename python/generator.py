@@ -549,6 +549,35 @@ foreign_encoding_args = (
     'xmlRecoverMemory',
 )
 
+# Potentially long-running functions which are called with the GIL
+# released. Python callbacks they can trigger (I/O, entity loaders, error
+# handlers, XPath extension functions) reacquire it in libxml.c.
+nogil_functions = (
+    'htmlReadFile',
+    'htmlReadMemory',
+    'htmlSaveFile',
+    'htmlSaveFileEnc',
+    'htmlSaveFileFormat',
+    'xmlParseFile',
+    'xmlParseMemory',
+    'xmlReadFile',
+    'xmlReadMemory',
+    'xmlRecoverFile',
+    'xmlRecoverMemory',
+    'xmlRelaxNGParse',
+    'xmlRelaxNGValidateDoc',
+    'xmlSaveFile',
+    'xmlSaveFileEnc',
+    'xmlSaveFormatFile',
+    'xmlSaveFormatFileEnc',
+    'xmlSchemaParse',
+    'xmlSchemaValidateDoc',
+    'xmlValidateDocument',
+    'xmlXPathCompiledEval',
+    'xmlXPathEval',
+    'xmlXPathEvalExpression',
+)
+
 #######################################################################
 #
 #  This part writes the C <-> Python stubs libxml2-py.[ch] and
@@ -825,10 +854,20 @@ def print_function_wrapper(name, output, export, include):
         if arg[1] in py_types:
             (f, t, n, c) = py_types[arg[1]]
             if (f == 'z') and (name in foreign_encoding_args) and (num_bufs == 0):
-                f = 's#'
+                # Accept any object supporting the buffer protocol
+                f = 's*'
             if f != None:
                 format = format + f
-            if t != None:
+            if f == 's*':
+                format_args = format_args + ", &py_buffer%d" % num_bufs
+                c_args = c_args + "    Py_buffer py_buffer%d;\n" % num_bufs
+                c_convert = c_convert + \
+                   "    %s = (%s) py_buffer%d.buf;\n" % (arg[0], arg[1],
+                   num_bufs)
+                c_release = c_release + \
+                   "    PyBuffer_Release(&py_buffer%d);\n" % num_bufs
+                num_bufs = num_bufs + 1
+            elif t != None:
                 format_args = format_args + ", &pyobj_%s" % (arg[0])
                 c_args = c_args + "    PyObject *pyobj_%s;\n" % (arg[0])
                 c_convert = c_convert + \
@@ -836,10 +875,6 @@ def print_function_wrapper(name, output, export, include):
                    arg[1], t, arg[0])
             else:
                 format_args = format_args + ", &%s" % (arg[0])
-            if f == 's#':
-                format_args = format_args + ", &py_buffsize%d" % num_bufs
-                c_args = c_args + "    Py_ssize_t  py_buffsize%d;\n" % num_bufs
-                num_bufs = num_bufs + 1
             if c_call != "":
                 c_call = c_call + ", "
             c_call = c_call + "%s" % (arg[0])
@@ -896,6 +931,10 @@ def print_function_wrapper(name, output, export, include):
             unknown_types[ret[0]] = [name]
         return -1
 
+    if name in nogil_functions:
+        c_call = "\n    Py_BEGIN_ALLOW_THREADS%s    Py_END_ALLOW_THREADS\n" % (
+                 c_call)
+
     if cond != None and cond != "":
         include.write("#if %s\n" % cond)
         export.write("#if %s\n" % cond)
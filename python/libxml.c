@@ -25,6 +25,7 @@
 #include <libxml/xmlIO.h>
 #include <libxml/c14n.h>
 #include <libxml/xmlreader.h>
+#include <libxml/pattern.h>
 #include <libxml/xmlsave.h>
 #include "libxml_wrap.h"
 #include "libxml2-py.h"
@@ -205,7 +206,7 @@ libxml_xmlPythonCleanupParser(PyObject *self ATTRIBUTE_UNUSED,
  * Close an I/O channel
  */
 static int
-xmlPythonFileCloseRaw (void * context) {
+xmlPythonFileCloseRawLocked (void * context) {
     PyObject *file, *ret;
 
     file = (PyObject *) context;
@@ -229,7 +230,7 @@ xmlPythonFileCloseRaw (void * context) {
  * Returns the number of bytes read
  */
 static int
-xmlPythonFileReadRaw (void * context, char * buffer, int len) {
+xmlPythonFileReadRawLocked (void * context, char * buffer, int len) {
     PyObject *file;
     PyObject *ret;
     int lenread = -1;
@@ -307,7 +308,7 @@ xmlPythonFileReadRaw (void * context, char * buffer, int len) {
  * Returns the number of bytes read
  */
 static int
-xmlPythonFileRead (void * context, char * buffer, int len) {
+xmlPythonFileReadLocked (void * context, char * buffer, int len) {
     PyObject *file;
     PyObject *ret;
     int lenread = -1;
@@ -386,7 +387,7 @@ xmlPythonFileRead (void * context, char * buffer, int len) {
  * Returns the number of bytes written
  */
 static int
-xmlPythonFileWrite (void * context, const char * buffer, int len) {
+xmlPythonFileWriteLocked (void * context, const char * buffer, int len) {
     PyObject *file;
     PyObject *string;
     PyObject *ret = NULL;
@@ -428,7 +429,7 @@ xmlPythonFileWrite (void * context, const char * buffer, int len) {
  * Close an I/O channel
  */
 static int
-xmlPythonFileClose (void * context) {
+xmlPythonFileCloseLocked (void * context) {
     PyObject *file, *ret = NULL;
 
     file = (PyObject *) context;
@@ -444,6 +445,57 @@ xmlPythonFileClose (void * context) {
     return(0);
 }
 
+/*
+ * The I/O callbacks can be invoked from calls which released the GIL,
+ * so they have to reacquire it before touching any Python object.
+ */
+static int
+xmlPythonFileCloseRaw (void * context) {
+    PyGILState_STATE state = PyGILState_Ensure();
+    int ret = xmlPythonFileCloseRawLocked(context);
+
+    PyGILState_Release(state);
+    return(ret);
+}
+
+static int
+xmlPythonFileReadRaw (void * context, char * buffer, int len) {
+    PyGILState_STATE state = PyGILState_Ensure();
+    int ret = xmlPythonFileReadRawLocked(context, buffer, len);
+
+    PyGILState_Release(state);
+    return(ret);
+}
+
+static int
+xmlPythonFileRead (void * context, char * buffer, int len) {
+    PyGILState_STATE state = PyGILState_Ensure();
+    int ret = xmlPythonFileReadLocked(context, buffer, len);
+
+    PyGILState_Release(state);
+    return(ret);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static int
+xmlPythonFileWrite (void * context, const char * buffer, int len) {
+    PyGILState_STATE state = PyGILState_Ensure();
+    int ret = xmlPythonFileWriteLocked(context, buffer, len);
+
+    PyGILState_Release(state);
+    return(ret);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+static int
+xmlPythonFileClose (void * context) {
+    PyGILState_STATE state = PyGILState_Ensure();
+    int ret = xmlPythonFileCloseLocked(context);
+
+    PyGILState_Release(state);
+    return(ret);
+}
+
 #ifdef LIBXML_OUTPUT_ENABLED
 /**
  * xmlOutputBufferCreatePythonFile:
@@ -678,9 +730,11 @@ pythonExternalEntityLoader(const char *URL, const char *ID,
 			   xmlParserCtxtPtr ctxt) {
     xmlParserInputPtr result = NULL;
     if (pythonExternalEntityLoaderObjext != NULL) {
+	PyGILState_STATE state;
 	PyObject *ret;
 	PyObject *ctxtobj;
 
+	state = PyGILState_Ensure();
 	ctxtobj = libxml_xmlParserCtxtPtrWrap(ctxt);
 
 	ret = PyObject_CallFunction(pythonExternalEntityLoaderObjext,
@@ -711,6 +765,7 @@ pythonExternalEntityLoader(const char *URL, const char *ID,
 		result->filename = (char *) xmlStrdup((const xmlChar *)URL);
 	    }
 	}
+	PyGILState_Release(state);
     }
     if ((result == NULL) && (defaultExternalEntityLoader != NULL)) {
 	result = defaultExternalEntityLoader(URL, ID, ctxt);
@@ -763,14 +818,17 @@ pythonInputMatchCallback(ATTRIBUTE_UNUSED const char *URI)
 static void *
 pythonInputOpenCallback(const char *URI)
 {
+    PyGILState_STATE state;
     PyObject *ret;
 
+    state = PyGILState_Ensure();
     ret = PyObject_CallFunction(pythonInputOpenCallbackObject,
 	    "s", URI);
     if (ret == Py_None) {
 	Py_DECREF(Py_None);
-	return NULL;
+	ret = NULL;
     }
+    PyGILState_Release(state);
     return ret;
 }
 
@@ -1487,6 +1545,7 @@ libxml_xmlErrorFuncHandler(ATTRIBUTE_UNUSED void *ctx, const char *msg,
     PyObject *list;
     PyObject *message;
     PyObject *result;
+    PyGILState_STATE state;
     char str[1024];
 
     if (libxml_xmlPythonErrorFuncHandler == NULL) {
@@ -1498,6 +1557,7 @@ libxml_xmlErrorFuncHandler(ATTRIBUTE_UNUSED void *ctx, const char *msg,
         vsnprintf(str, sizeof(str), msg, ap);
         va_end(ap);
 
+        state = PyGILState_Ensure();
         list = PyTuple_New(2);
         PyTuple_SetItem(list, 0, libxml_xmlPythonErrorFuncCtxt);
         Py_XINCREF(libxml_xmlPythonErrorFuncCtxt);
@@ -1506,6 +1566,7 @@ libxml_xmlErrorFuncHandler(ATTRIBUTE_UNUSED void *ctx, const char *msg,
         result = PyObject_CallObject(libxml_xmlPythonErrorFuncHandler, list);
         Py_XDECREF(list);
         Py_XDECREF(result);
+        PyGILState_Release(state);
     }
 }
 
@@ -1568,6 +1629,7 @@ libxml_xmlParserCtxtErrorHandler(void *ctx, const xmlError *error)
 {
     PyObject *list;
     PyObject *result;
+    PyGILState_STATE state;
     xmlParserCtxtPtr ctxt;
     xmlParserCtxtPyCtxtPtr pyCtxt;
     int severity;
@@ -1588,6 +1650,8 @@ libxml_xmlParserCtxtErrorHandler(void *ctx, const xmlError *error)
             severity = XML_PARSER_SEVERITY_ERROR;
     }
 
+    state = PyGILState_Ensure();
+
     list = PyTuple_New(4);
     PyTuple_SetItem(list, 0, pyCtxt->arg);
     Py_XINCREF(pyCtxt->arg);
@@ -1603,6 +1667,7 @@ libxml_xmlParserCtxtErrorHandler(void *ctx, const xmlError *error)
     }
     Py_XDECREF(list);
     Py_XDECREF(result);
+    PyGILState_Release(state);
 }
 
 static PyObject *
@@ -1723,10 +1788,13 @@ libxml_xmlValidCtxtGenericErrorFuncHandler(void *ctx, ATTRIBUTE_UNUSED int sever
 {
     PyObject *list;
     PyObject *result;
+    PyGILState_STATE state;
     xmlValidCtxtPyCtxtPtr pyCtxt;
     
     pyCtxt = (xmlValidCtxtPyCtxtPtr)ctx;
     
+    state = PyGILState_Ensure();
+
     list = PyTuple_New(2);
     PyTuple_SetItem(list, 0, libxml_charPtrWrap(str));
     PyTuple_SetItem(list, 1, pyCtxt->arg);
@@ -1739,6 +1807,7 @@ libxml_xmlValidCtxtGenericErrorFuncHandler(void *ctx, ATTRIBUTE_UNUSED int sever
     }
     Py_XDECREF(list);
     Py_XDECREF(result);
+    PyGILState_Release(state);
 }
 
 static void
@@ -1746,10 +1815,13 @@ libxml_xmlValidCtxtGenericWarningFuncHandler(void *ctx, ATTRIBUTE_UNUSED int sev
 {
     PyObject *list;
     PyObject *result;
+    PyGILState_STATE state;
     xmlValidCtxtPyCtxtPtr pyCtxt;
     
     pyCtxt = (xmlValidCtxtPyCtxtPtr)ctx;
 
+    state = PyGILState_Ensure();
+
     list = PyTuple_New(2);
     PyTuple_SetItem(list, 0, libxml_charPtrWrap(str));
     PyTuple_SetItem(list, 1, pyCtxt->arg);
@@ -1762,6 +1834,7 @@ libxml_xmlValidCtxtGenericWarningFuncHandler(void *ctx, ATTRIBUTE_UNUSED int sev
     }
     Py_XDECREF(list);
     Py_XDECREF(result);
+    PyGILState_Release(state);
 }
 
 static void 
@@ -2027,6 +2100,454 @@ libxml_xmlFreeTextReader(ATTRIBUTE_UNUSED PyObject *self, PyObject *args) {
 }
 #endif
 
+#if defined(LIBXML_READER_ENABLED) && defined(LIBXML_PATTERN_ENABLED)
+/************************************************************************
+ *									*
+ *			Iterative parsing				*
+ *									*
+ ************************************************************************/
+
+/*
+ * Wrapping every node returned by an xmlTextReader costs much more than
+ * reading it. The iterative parser reads a whole batch of nodes in C
+ * with the GIL released and only converts the result:
+ *
+ * - with a pattern, copies of the matching subtrees. Matches are found
+ *   with a stream context, so nodes outside of them are never expanded
+ *   and are freed by the reader as usual. The copies belong to a
+ *   document which is freed when the next batch is read.
+ * - otherwise, start, end and text events.
+ */
+
+#define LIBXML_ITER_START	(1 << 0)
+#define LIBXML_ITER_END		(1 << 1)
+#define LIBXML_ITER_TEXT	(1 << 2)
+
+typedef struct {
+    int event;
+    xmlChar *name;
+    xmlChar **attrs;		/* name/value pairs, NULL terminated */
+    xmlChar *text;
+} libxml_iterEvent;
+
+typedef struct {
+    xmlTextReaderPtr reader;
+    xmlPatternPtr pattern;
+    xmlStreamCtxtPtr stream;
+    Py_buffer input;		/* memory input, kept until the end */
+    int events;			/* mask of LIBXML_ITER_* */
+    int skip;			/* skip the subtree of the current node */
+    xmlDocPtr matches;		/* copies of the subtrees of a batch */
+    libxml_iterEvent *tab;
+    int nr;
+    int max;
+} libxml_iterParser;
+
+static void
+libxml_iterClearEvents(libxml_iterParser *it)
+{
+    libxml_iterEvent *ev;
+    int i, j;
+
+    for (i = 0; i < it->nr; i++) {
+        ev = &it->tab[i];
+        xmlFree(ev->name);
+        xmlFree(ev->text);
+        if (ev->attrs != NULL) {
+            for (j = 0; ev->attrs[j] != NULL; j++)
+                xmlFree(ev->attrs[j]);
+            xmlFree(ev->attrs);
+        }
+    }
+    it->nr = 0;
+}
+
+static libxml_iterEvent *
+libxml_iterAddEvent(libxml_iterParser *it, int event)
+{
+    libxml_iterEvent *ev;
+
+    if (it->nr >= it->max) {
+        libxml_iterEvent *tmp;
+        int max = (it->max > 0) ? it->max * 2 : 64;
+
+        tmp = xmlRealloc(it->tab, max * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return (NULL);
+        it->tab = tmp;
+        it->max = max;
+    }
+    ev = &it->tab[it->nr++];
+    memset(ev, 0, sizeof(*ev));
+    ev->event = event;
+    return (ev);
+}
+
+static int
+libxml_iterStartEvent(libxml_iterParser *it, xmlTextReaderPtr reader)
+{
+    libxml_iterEvent *ev;
+    int n, i = 0;
+
+    ev = libxml_iterAddEvent(it, LIBXML_ITER_START);
+    if (ev == NULL)
+        return (-1);
+    ev->name = xmlStrdup(xmlTextReaderConstName(reader));
+    if (ev->name == NULL)
+        return (-1);
+
+    n = xmlTextReaderAttributeCount(reader);
+    if (n <= 0)
+        return (0);
+    ev->attrs = xmlMalloc((2 * n + 1) * sizeof(xmlChar *));
+    if (ev->attrs == NULL)
+        return (-1);
+    ev->attrs[0] = NULL;
+    while ((i < 2 * n) && (xmlTextReaderMoveToNextAttribute(reader) == 1)) {
+        if (xmlTextReaderIsNamespaceDecl(reader))
+            continue;
+        ev->attrs[i] = xmlStrdup(xmlTextReaderConstName(reader));
+        ev->attrs[i + 1] = NULL;
+        if (ev->attrs[i] == NULL)
+            return (-1);
+        ev->attrs[i + 1] = xmlTextReaderValue(reader);
+        ev->attrs[i + 2] = NULL;
+        if (ev->attrs[i + 1] == NULL)
+            return (-1);
+        i += 2;
+    }
+    xmlTextReaderMoveToElement(reader);
+    if (i == 0) {
+        /* only namespace declarations */
+        xmlFree(ev->attrs);
+        ev->attrs = NULL;
+    }
+    return (0);
+}
+
+static int
+libxml_iterEndEvent(libxml_iterParser *it, xmlTextReaderPtr reader)
+{
+    libxml_iterEvent *ev;
+
+    ev = libxml_iterAddEvent(it, LIBXML_ITER_END);
+    if (ev == NULL)
+        return (-1);
+    ev->name = xmlStrdup(xmlTextReaderConstName(reader));
+    return ((ev->name == NULL) ? -1 : 0);
+}
+
+static int
+libxml_iterTextEvent(libxml_iterParser *it, xmlTextReaderPtr reader)
+{
+    libxml_iterEvent *ev;
+
+    ev = libxml_iterAddEvent(it, LIBXML_ITER_TEXT);
+    if (ev == NULL)
+        return (-1);
+    ev->text = xmlTextReaderValue(reader);
+    return ((ev->text == NULL) ? -1 : 0);
+}
+
+/*
+ * Handle the current node of the reader. Returns the number of items
+ * added to the batch or -1 in case of error.
+ */
+static int
+libxml_iterNode(libxml_iterParser *it)
+{
+    xmlTextReaderPtr reader = it->reader;
+    xmlNodePtr node, copy;
+    int empty, ret;
+
+    switch (xmlTextReaderNodeType(reader)) {
+        case XML_READER_TYPE_ELEMENT:
+            empty = xmlTextReaderIsEmptyElement(reader);
+            if (it->stream == NULL) {
+                ret = 0;
+                if (it->events & LIBXML_ITER_START) {
+                    if (libxml_iterStartEvent(it, reader) < 0)
+                        return (-1);
+                    ret++;
+                }
+                if ((empty) && (it->events & LIBXML_ITER_END)) {
+                    if (libxml_iterEndEvent(it, reader) < 0)
+                        return (-1);
+                    ret++;
+                }
+                return (ret);
+            }
+
+            ret = xmlStreamPush(it->stream,
+                                xmlTextReaderConstLocalName(reader),
+                                xmlTextReaderConstNamespaceUri(reader));
+            if (ret < 0)
+                return (-1);
+            if (ret == 1) {
+                node = xmlTextReaderExpand(reader);
+                if (node == NULL)
+                    return (-1);
+                copy = xmlDocCopyNode(node, it->matches, 1);
+                if (copy == NULL)
+                    return (-1);
+                xmlAddChild((xmlNodePtr) it->matches, copy);
+                it->skip = 1;
+                empty = 1;
+            }
+            if ((empty) && (xmlStreamPop(it->stream) < 0))
+                return (-1);
+            return (ret);
+
+        case XML_READER_TYPE_END_ELEMENT:
+            if (it->stream != NULL)
+                return ((xmlStreamPop(it->stream) < 0) ? -1 : 0);
+            if ((it->events & LIBXML_ITER_END) == 0)
+                return (0);
+            return ((libxml_iterEndEvent(it, reader) < 0) ? -1 : 1);
+
+        case XML_READER_TYPE_TEXT:
+        case XML_READER_TYPE_CDATA:
+        case XML_READER_TYPE_WHITESPACE:
+        case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+            if ((it->stream != NULL) || ((it->events & LIBXML_ITER_TEXT) == 0))
+                return (0);
+            return ((libxml_iterTextEvent(it, reader) < 0) ? -1 : 1);
+
+        default:
+            return (0);
+    }
+}
+
+/*
+ * Read until size items were collected or the document ends. Runs
+ * without the GIL. Returns the number of items or -1 in case of error.
+ */
+static int
+libxml_iterBatch(libxml_iterParser *it, int size)
+{
+    int count = 0;
+    int ret;
+
+    while (count < size) {
+        if (it->skip) {
+            it->skip = 0;
+            ret = xmlTextReaderNext(it->reader);
+        } else {
+            ret = xmlTextReaderRead(it->reader);
+        }
+        if (ret <= 0)
+            return ((ret < 0) ? -1 : count);
+        ret = libxml_iterNode(it);
+        if (ret < 0)
+            return (-1);
+        count += ret;
+    }
+    return (count);
+}
+
+static void
+libxml_iterParserFree(libxml_iterParser *it)
+{
+    libxml_iterClearEvents(it);
+    xmlFree(it->tab);
+    if (it->matches != NULL)
+        xmlFreeDoc(it->matches);
+    if (it->stream != NULL)
+        xmlFreeStreamCtxt(it->stream);
+    if (it->pattern != NULL)
+        xmlFreePattern(it->pattern);
+    if (it->reader != NULL)
+        xmlFreeTextReader(it->reader);
+    if (it->input.obj != NULL)
+        PyBuffer_Release(&it->input);
+    xmlFree(it);
+}
+
+static void
+libxml_iterParserDestruct(PyObject *cap)
+{
+    libxml_iterParser *it;
+
+    it = (libxml_iterParser *) PyCapsule_GetPointer(cap, "iterParser");
+    if (it != NULL)
+        libxml_iterParserFree(it);
+}
+
+static PyObject *
+libxml_xmlIterParseNew(ATTRIBUTE_UNUSED PyObject * self, PyObject * args)
+{
+    libxml_iterParser *it;
+    PyObject *pyobj_ns;
+    const xmlChar **namespaces = NULL;
+    const char *filename, *pattern;
+    Py_buffer input;
+    Py_ssize_t i, nbNs;
+    int events, options;
+
+    if (!PyArg_ParseTuple(args, "zz*zOii:xmlIterParseNew", &filename,
+                          &input, &pattern, &pyobj_ns, &events, &options))
+        return (NULL);
+
+    it = xmlMalloc(sizeof(*it));
+    if (it == NULL) {
+        if (input.obj != NULL)
+            PyBuffer_Release(&input);
+        return (PyErr_NoMemory());
+    }
+    memset(it, 0, sizeof(*it));
+    it->input = input;
+    it->events = events;
+
+    if (filename != NULL)
+        it->reader = xmlReaderForFile(filename, NULL, options);
+    else if (input.obj != NULL)
+        it->reader = xmlReaderForMemory(input.buf, input.len, NULL, NULL,
+                                        options);
+    if (it->reader == NULL)
+        goto error;
+
+    if (pattern != NULL) {
+        if (PyList_Check(pyobj_ns)) {
+            nbNs = PyList_Size(pyobj_ns);
+            namespaces = xmlMalloc((nbNs + 2) * sizeof(xmlChar *));
+            if (namespaces == NULL)
+                goto error;
+            for (i = 0; i < nbNs; i++) {
+                namespaces[i] = (const xmlChar *)
+                    PyUnicode_AsUTF8(PyList_GetItem(pyobj_ns, i));
+                if (namespaces[i] == NULL)
+                    goto error;
+            }
+            namespaces[nbNs] = NULL;
+            namespaces[nbNs + 1] = NULL;
+        }
+        it->pattern = xmlPatterncompile((const xmlChar *) pattern, NULL, 0,
+                                        namespaces);
+        if (it->pattern == NULL)
+            goto error;
+        it->stream = xmlPatternGetStreamCtxt(it->pattern);
+        if ((it->stream == NULL) || (xmlStreamPush(it->stream, NULL, NULL) < 0))
+            goto error;
+    }
+
+    xmlFree(namespaces);
+    return (PyCapsule_New((void *) it, (char *) "iterParser",
+                          libxml_iterParserDestruct));
+
+error:
+    xmlFree(namespaces);
+    libxml_iterParserFree(it);
+    if (PyErr_Occurred())
+        return (NULL);
+    Py_INCREF(Py_None);
+    return (Py_None);
+}
+
+static PyObject *
+libxml_iterEventWrap(libxml_iterEvent *ev)
+{
+    PyObject *ret, *attrs, *key, *value;
+    const char *event;
+    int i;
+
+    if (ev->event == LIBXML_ITER_START)
+        event = "start";
+    else if (ev->event == LIBXML_ITER_END)
+        event = "end";
+    else
+        event = "text";
+
+    if (ev->attrs != NULL) {
+        attrs = PyDict_New();
+        if (attrs == NULL)
+            return (NULL);
+        for (i = 0; ev->attrs[i] != NULL; i += 2) {
+            key = libxml_xmlCharPtrWrap(ev->attrs[i]);
+            value = libxml_xmlCharPtrWrap(ev->attrs[i + 1]);
+            ev->attrs[i] = NULL;
+            ev->attrs[i + 1] = NULL;
+            if ((key == NULL) || (value == NULL) ||
+                (PyDict_SetItem(attrs, key, value) < 0)) {
+                Py_XDECREF(key);
+                Py_XDECREF(value);
+                Py_DECREF(attrs);
+                return (NULL);
+            }
+            Py_DECREF(key);
+            Py_DECREF(value);
+        }
+    } else {
+        Py_INCREF(Py_None);
+        attrs = Py_None;
+    }
+
+    ret = Py_BuildValue("(sNNN)", event, libxml_xmlCharPtrWrap(ev->name),
+                        attrs, libxml_xmlCharPtrWrap(ev->text));
+    ev->name = NULL;
+    ev->text = NULL;
+    return (ret);
+}
+
+static PyObject *
+libxml_xmlIterParseNext(ATTRIBUTE_UNUSED PyObject * self, PyObject * args)
+{
+    libxml_iterParser *it;
+    PyObject *pyobj_it, *ret, *item;
+    xmlNodePtr cur;
+    int size, count, i;
+
+    if (!PyArg_ParseTuple(args, "Oi:xmlIterParseNext", &pyobj_it, &size))
+        return (NULL);
+    it = (libxml_iterParser *) PyCapsule_GetPointer(pyobj_it, "iterParser");
+    if (it == NULL)
+        return (NULL);
+
+    /* The subtrees returned by the previous batch are released here */
+    if (it->matches != NULL) {
+        xmlFreeDoc(it->matches);
+        it->matches = NULL;
+    }
+    if (it->stream != NULL) {
+        it->matches = xmlNewDoc(BAD_CAST "1.0");
+        if (it->matches == NULL)
+            return (PyErr_NoMemory());
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    count = libxml_iterBatch(it, (size > 0) ? size : 1);
+    Py_END_ALLOW_THREADS
+
+    if (count < 0) {
+        libxml_iterClearEvents(it);
+        Py_INCREF(Py_None);
+        return (Py_None);
+    }
+
+    ret = PyList_New(count);
+    if (ret == NULL)
+        goto done;
+    if (it->stream != NULL) {
+        cur = it->matches->children;
+        for (i = 0; (i < count) && (cur != NULL); i++, cur = cur->next)
+            PyList_SET_ITEM(ret, i, libxml_xmlNodePtrWrap(cur));
+    } else {
+        for (i = 0; i < count; i++) {
+            item = libxml_iterEventWrap(&it->tab[i]);
+            if (item == NULL) {
+                Py_DECREF(ret);
+                ret = NULL;
+                goto done;
+            }
+            PyList_SET_ITEM(ret, i, item);
+        }
+    }
+
+done:
+    libxml_iterClearEvents(it);
+    return (ret);
+}
+#endif /* LIBXML_READER_ENABLED && LIBXML_PATTERN_ENABLED */
+
 /************************************************************************
  *									*
  *			XPath extensions				*
@@ -2044,6 +2565,7 @@ libxml_xmlXPathFuncCallback(xmlXPathParserContextPtr ctxt, int nargs)
     const xmlChar *name;
     const xmlChar *ns_uri;
     int i;
+    PyGILState_STATE state;
 
     if (ctxt == NULL)
         return;
@@ -2070,6 +2592,7 @@ libxml_xmlXPathFuncCallback(xmlXPathParserContextPtr ctxt, int nargs)
         return;
     }
 
+    state = PyGILState_Ensure();
     list = PyTuple_New(nargs + 1);
     PyTuple_SetItem(list, 0, libxml_xmlXPathParserContextPtrWrap(ctxt));
     for (i = nargs - 1; i >= 0; i--) {
@@ -2082,6 +2605,7 @@ libxml_xmlXPathFuncCallback(xmlXPathParserContextPtr ctxt, int nargs)
 
     obj = libxml_xmlXPathObjectPtrConvert(result);
     xmlXPathValuePush(ctxt, obj);
+    PyGILState_Release(state);
 }
 
 static xmlXPathFunction
@@ -2208,6 +2732,228 @@ libxml_xmlXPathRegisterVariable(ATTRIBUTE_UNUSED PyObject * self,
     py_retval = libxml_intWrap(c_retval);
     return (py_retval);
 }
+
+/*
+ * Bulk access to node-set results
+ *
+ * Wrapping every node of a large result in a Python object dominates
+ * the cost of a query. The functions below extract the values needed
+ * from the node-set in C, or keep the node-set around and only wrap the
+ * nodes which are actually accessed.
+ */
+
+#define LIBXML_XPATH_STRINGS	0
+#define LIBXML_XPATH_ATTRS	1
+#define LIBXML_XPATH_NAME_TEXT	2
+
+static xmlXPathObjectPtr
+libxml_xpathEvalNodeSet(xmlXPathContextPtr ctxt, const xmlChar *expr)
+{
+    xmlXPathObjectPtr obj;
+
+    Py_BEGIN_ALLOW_THREADS
+    obj = xmlXPathEval(expr, ctxt);
+    Py_END_ALLOW_THREADS
+
+    if ((obj != NULL) && (obj->type != XPATH_NODESET)) {
+        xmlXPathFreeObject(obj);
+        obj = NULL;
+    }
+    return (obj);
+}
+
+static PyObject *
+libxml_xpathNodeValue(xmlNodePtr node, int mode, const xmlChar *name,
+                      const xmlChar *ns_uri)
+{
+    PyObject *ret;
+    const xmlChar *nodeName;
+
+    switch (mode) {
+        case LIBXML_XPATH_ATTRS:
+            if (node->type != XML_ELEMENT_NODE) {
+                Py_INCREF(Py_None);
+                return (Py_None);
+            }
+            if (ns_uri != NULL)
+                return (libxml_xmlCharPtrWrap(xmlGetNsProp(node, name,
+                                                           ns_uri)));
+            return (libxml_xmlCharPtrWrap(xmlGetProp(node, name)));
+        case LIBXML_XPATH_NAME_TEXT:
+            if (node->type == XML_NAMESPACE_DECL)
+                nodeName = ((xmlNsPtr) node)->prefix;
+            else
+                nodeName = node->name;
+            ret = PyTuple_New(2);
+            if (ret == NULL)
+                return (NULL);
+            PyTuple_SetItem(ret, 0, libxml_constxmlCharPtrWrap(nodeName));
+            PyTuple_SetItem(ret, 1,
+                    libxml_xmlCharPtrWrap(xmlXPathCastNodeToString(node)));
+            return (ret);
+        default:
+            return (libxml_xmlCharPtrWrap(xmlXPathCastNodeToString(node)));
+    }
+}
+
+static PyObject *
+libxml_xpathEvalValues(PyObject *pyobj_ctxt, const xmlChar *expr, int mode,
+                       const xmlChar *name, const xmlChar *ns_uri)
+{
+    PyObject *ret, *item;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr obj;
+    xmlNodeSetPtr set;
+    int i, nr;
+
+    ctxt = (xmlXPathContextPtr) PyxmlXPathContext_Get(pyobj_ctxt);
+    obj = libxml_xpathEvalNodeSet(ctxt, expr);
+    if (obj == NULL) {
+        Py_INCREF(Py_None);
+        return (Py_None);
+    }
+
+    set = obj->nodesetval;
+    nr = (set != NULL) ? set->nodeNr : 0;
+    ret = PyList_New(nr);
+    if (ret == NULL)
+        goto done;
+    for (i = 0; i < nr; i++) {
+        item = libxml_xpathNodeValue(set->nodeTab[i], mode, name, ns_uri);
+        if (item == NULL) {
+            Py_DECREF(ret);
+            ret = NULL;
+            goto done;
+        }
+        PyList_SET_ITEM(ret, i, item);
+    }
+
+done:
+    xmlXPathFreeObject(obj);
+    return (ret);
+}
+
+static PyObject *
+libxml_xmlXPathEvalStrings(ATTRIBUTE_UNUSED PyObject * self,
+                           PyObject * args)
+{
+    PyObject *pyobj_ctxt;
+    xmlChar *expr;
+
+    if (!PyArg_ParseTuple(args, "Os:xmlXPathEvalStrings", &pyobj_ctxt,
+                          &expr))
+        return (NULL);
+    return (libxml_xpathEvalValues(pyobj_ctxt, expr, LIBXML_XPATH_STRINGS,
+                                   NULL, NULL));
+}
+
+static PyObject *
+libxml_xmlXPathEvalAttrValues(ATTRIBUTE_UNUSED PyObject * self,
+                              PyObject * args)
+{
+    PyObject *pyobj_ctxt;
+    xmlChar *expr, *name, *ns_uri;
+
+    if (!PyArg_ParseTuple(args, "Ossz:xmlXPathEvalAttrValues",
+                          &pyobj_ctxt, &expr, &name, &ns_uri))
+        return (NULL);
+    return (libxml_xpathEvalValues(pyobj_ctxt, expr, LIBXML_XPATH_ATTRS,
+                                   name, ns_uri));
+}
+
+static PyObject *
+libxml_xmlXPathEvalNameText(ATTRIBUTE_UNUSED PyObject * self,
+                            PyObject * args)
+{
+    PyObject *pyobj_ctxt;
+    xmlChar *expr;
+
+    if (!PyArg_ParseTuple(args, "Os:xmlXPathEvalNameText", &pyobj_ctxt,
+                          &expr))
+        return (NULL);
+    return (libxml_xpathEvalValues(pyobj_ctxt, expr, LIBXML_XPATH_NAME_TEXT,
+                                   NULL, NULL));
+}
+
+static void
+libxml_xpathDestructNodeSet(PyObject *cap)
+{
+    xmlXPathFreeObject((xmlXPathObjectPtr)
+            PyCapsule_GetPointer(cap, "xmlXPathObjectPtr"));
+}
+
+static PyObject *
+libxml_xmlXPathEvalNodeSet(ATTRIBUTE_UNUSED PyObject * self,
+                           PyObject * args)
+{
+    PyObject *pyobj_ctxt;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr obj;
+    xmlChar *expr;
+
+    if (!PyArg_ParseTuple(args, "Os:xmlXPathEvalNodeSet", &pyobj_ctxt,
+                          &expr))
+        return (NULL);
+    ctxt = (xmlXPathContextPtr) PyxmlXPathContext_Get(pyobj_ctxt);
+    obj = libxml_xpathEvalNodeSet(ctxt, expr);
+    if (obj == NULL) {
+        Py_INCREF(Py_None);
+        return (Py_None);
+    }
+    return (PyCapsule_New((void *) obj, (char *) "xmlXPathObjectPtr",
+                          libxml_xpathDestructNodeSet));
+}
+
+static xmlNodeSetPtr
+libxml_xpathNodeSetGet(PyObject *obj)
+{
+    xmlXPathObjectPtr xpobj;
+
+    xpobj = (xmlXPathObjectPtr) PyCapsule_GetPointer(obj,
+                                                     "xmlXPathObjectPtr");
+    if (xpobj == NULL)
+        return (NULL);
+    return (xpobj->nodesetval);
+}
+
+static PyObject *
+libxml_xmlXPathNodeSetSize(ATTRIBUTE_UNUSED PyObject * self,
+                           PyObject * args)
+{
+    PyObject *obj;
+    xmlNodeSetPtr set;
+
+    if (!PyArg_ParseTuple(args, "O:xmlXPathNodeSetSize", &obj))
+        return (NULL);
+    set = libxml_xpathNodeSetGet(obj);
+    if (PyErr_Occurred())
+        return (NULL);
+    return (libxml_intWrap((set != NULL) ? set->nodeNr : 0));
+}
+
+static PyObject *
+libxml_xmlXPathNodeSetItem(ATTRIBUTE_UNUSED PyObject * self,
+                           PyObject * args)
+{
+    PyObject *obj;
+    xmlNodeSetPtr set;
+    xmlNodePtr node;
+    int index;
+
+    if (!PyArg_ParseTuple(args, "Oi:xmlXPathNodeSetItem", &obj, &index))
+        return (NULL);
+    set = libxml_xpathNodeSetGet(obj);
+    if (PyErr_Occurred())
+        return (NULL);
+    if ((set == NULL) || (index < 0) || (index >= set->nodeNr)) {
+        PyErr_SetString(PyExc_IndexError, "node set index out of range");
+        return (NULL);
+    }
+    node = set->nodeTab[index];
+    if (node->type == XML_NAMESPACE_DECL)
+        return (libxml_xmlXPathNsNodeWrap((xmlNsPtr) node));
+    return (libxml_xmlNodePtrWrap(node));
+}
 #endif /* LIBXML_XPATH_ENABLED */
 
 /************************************************************************
@@ -2892,10 +3638,13 @@ libxml_xmlRelaxNGValidityGenericErrorFuncHandler(void *ctx, char *str)
 {
     PyObject *list;
     PyObject *result;
+    PyGILState_STATE state;
     xmlRelaxNGValidCtxtPyCtxtPtr pyCtxt;
     
     pyCtxt = (xmlRelaxNGValidCtxtPyCtxtPtr)ctx;
 
+    state = PyGILState_Ensure();
+
     list = PyTuple_New(2);
     PyTuple_SetItem(list, 0, libxml_charPtrWrap(str));
     PyTuple_SetItem(list, 1, pyCtxt->arg);
@@ -2908,6 +3657,7 @@ libxml_xmlRelaxNGValidityGenericErrorFuncHandler(void *ctx, char *str)
     }
     Py_XDECREF(list);
     Py_XDECREF(result);
+    PyGILState_Release(state);
 }
 
 static void
@@ -2915,10 +3665,13 @@ libxml_xmlRelaxNGValidityGenericWarningFuncHandler(void *ctx, char *str)
 {
     PyObject *list;
     PyObject *result;
+    PyGILState_STATE state;
     xmlRelaxNGValidCtxtPyCtxtPtr pyCtxt;
     
     pyCtxt = (xmlRelaxNGValidCtxtPyCtxtPtr)ctx;
 
+    state = PyGILState_Ensure();
+
     list = PyTuple_New(2);
     PyTuple_SetItem(list, 0, libxml_charPtrWrap(str));
     PyTuple_SetItem(list, 1, pyCtxt->arg);
@@ -2931,6 +3684,7 @@ libxml_xmlRelaxNGValidityGenericWarningFuncHandler(void *ctx, char *str)
     }
     Py_XDECREF(list);
     Py_XDECREF(result);
+    PyGILState_Release(state);
 }
 
 static void
@@ -3046,10 +3800,13 @@ libxml_xmlSchemaValidityGenericErrorFuncHandler(void *ctx, char *str)
 {
 	PyObject *list;
 	PyObject *result;
+	PyGILState_STATE state;
 	xmlSchemaValidCtxtPyCtxtPtr pyCtxt;
 
 	pyCtxt = (xmlSchemaValidCtxtPyCtxtPtr) ctx;
 
+	state = PyGILState_Ensure();
+
 	list = PyTuple_New(2);
 	PyTuple_SetItem(list, 0, libxml_charPtrWrap(str));
 	PyTuple_SetItem(list, 1, pyCtxt->arg);
@@ -3062,6 +3819,7 @@ libxml_xmlSchemaValidityGenericErrorFuncHandler(void *ctx, char *str)
 	}
 	Py_XDECREF(list);
 	Py_XDECREF(result);
+	PyGILState_Release(state);
 }
 
 static void
@@ -3069,10 +3827,13 @@ libxml_xmlSchemaValidityGenericWarningFuncHandler(void *ctx, char *str)
 {
 	PyObject *list;
 	PyObject *result;
+	PyGILState_STATE state;
 	xmlSchemaValidCtxtPyCtxtPtr pyCtxt;
 
 	pyCtxt = (xmlSchemaValidCtxtPyCtxtPtr) ctx;
 
+	state = PyGILState_Ensure();
+
 	list = PyTuple_New(2);
 	PyTuple_SetItem(list, 0, libxml_charPtrWrap(str));
 	PyTuple_SetItem(list, 1, pyCtxt->arg);
@@ -3085,6 +3846,7 @@ libxml_xmlSchemaValidityGenericWarningFuncHandler(void *ctx, char *str)
 	}
 	Py_XDECREF(list);
 	Py_XDECREF(result);
+	PyGILState_Release(state);
 }
 
 static void
@@ -3587,6 +4349,10 @@ static PyMethodDef libxmlMethods[] = {
     {"xmlTextReaderGetErrorHandler", libxml_xmlTextReaderGetErrorHandler, METH_VARARGS, NULL },
     {"xmlFreeTextReader", libxml_xmlFreeTextReader, METH_VARARGS, NULL },
 #endif
+#if defined(LIBXML_READER_ENABLED) && defined(LIBXML_PATTERN_ENABLED)
+    {"xmlIterParseNew", libxml_xmlIterParseNew, METH_VARARGS, NULL },
+    {"xmlIterParseNext", libxml_xmlIterParseNext, METH_VARARGS, NULL },
+#endif
 #ifdef LIBXML_CATALOG_ENABLED
     {"addLocalCatalog", libxml_addLocalCatalog, METH_VARARGS, NULL },
 #endif
@@ -3607,6 +4373,14 @@ static PyMethodDef libxmlMethods[] = {
     {"getObjDesc", libxml_getObjDesc, METH_VARARGS, NULL},
     {"compareNodesEqual", libxml_compareNodesEqual, METH_VARARGS, NULL},
     {"nodeHash", libxml_nodeHash, METH_VARARGS, NULL},
+#ifdef LIBXML_XPATH_ENABLED
+    {"xmlXPathEvalStrings", libxml_xmlXPathEvalStrings, METH_VARARGS, NULL},
+    {"xmlXPathEvalAttrValues", libxml_xmlXPathEvalAttrValues, METH_VARARGS, NULL},
+    {"xmlXPathEvalNameText", libxml_xmlXPathEvalNameText, METH_VARARGS, NULL},
+    {"xmlXPathEvalNodeSet", libxml_xmlXPathEvalNodeSet, METH_VARARGS, NULL},
+    {"xmlXPathNodeSetSize", libxml_xmlXPathNodeSetSize, METH_VARARGS, NULL},
+    {"xmlXPathNodeSetItem", libxml_xmlXPathNodeSetItem, METH_VARARGS, NULL},
+#endif /* LIBXML_XPATH_ENABLED */
     {"xmlRegisterInputCallback", libxml_xmlRegisterInputCallback, METH_VARARGS, NULL},
     {"xmlUnregisterInputCallback", libxml_xmlUnregisterInputCallback, METH_VARARGS, NULL},
     {NULL, NULL, 0, NULL}
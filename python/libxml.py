@@ -485,6 +485,33 @@ class xmlCore:
     def xpathEval2(self, expr):
         return self.xpathEval(expr)
 
+    #
+    # Bulk variants of xpathEval which don't create a Python object
+    # for every node of the result, see xpathEvalStrings() and friends.
+    #
+    def __xpathEvalBulk(self, func, *args):
+        doc = self.doc
+        if doc == None:
+            return None
+        ctxt = doc.xpathNewContext()
+        ctxt.setContextNode(self)
+        try:
+            return func(ctxt, *args)
+        finally:
+            ctxt.xpathFreeContext()
+
+    def xpathEvalStrings(self, expr):
+        return self.__xpathEvalBulk(xpathEvalStrings, expr)
+
+    def xpathEvalAttrValues(self, expr, name, ns_uri=None):
+        return self.__xpathEvalBulk(xpathEvalAttrValues, expr, name, ns_uri)
+
+    def xpathEvalNameText(self, expr):
+        return self.__xpathEvalBulk(xpathEvalNameText, expr)
+
+    def xpathEvalLazy(self, expr):
+        return self.__xpathEvalBulk(xpathEvalLazy, expr)
+
     # Remove namespaces
     def removeNsDef(self, href):
         """
@@ -610,6 +637,105 @@ def xpathObjectRet(o):
 def registerXPathFunction(ctxt, name, ns_uri, f):
     ret = libxml2mod.xmlRegisterXPathFunction(ctxt, name, ns_uri, f)
 
+#
+# Bulk access to node-set results. These evaluate expr in the
+# xpathContext ctxt and extract the values in C, which is much faster
+# than wrapping every node for large results.
+#
+def xpathEvalStrings(ctxt, expr):
+    """Return the list of the string-values of the selected nodes."""
+    ret = libxml2mod.xmlXPathEvalStrings(ctxt._o, expr)
+    if ret is None:raise xpathError('xmlXPathEval() failed')
+    return ret
+
+def xpathEvalAttrValues(ctxt, expr, name, ns_uri=None):
+    """Return the value of attribute name for each selected node,
+       None for nodes which aren't elements or lack the attribute."""
+    ret = libxml2mod.xmlXPathEvalAttrValues(ctxt._o, expr, name, ns_uri)
+    if ret is None:raise xpathError('xmlXPathEval() failed')
+    return ret
+
+def xpathEvalNameText(ctxt, expr):
+    """Return a (name, string-value) tuple for each selected node."""
+    ret = libxml2mod.xmlXPathEvalNameText(ctxt._o, expr)
+    if ret is None:raise xpathError('xmlXPathEval() failed')
+    return ret
+
+def xpathEvalLazy(ctxt, expr):
+    """Return the selected nodes as an xpathNodeSet sequence."""
+    ret = libxml2mod.xmlXPathEvalNodeSet(ctxt._o, expr)
+    if ret is None:raise xpathError('xmlXPathEval() failed')
+    return xpathNodeSet(ret)
+
+class xpathNodeSet:
+    """Read-only sequence over an XPath node-set. Nodes are only wrapped
+       when they are accessed. The document must outlive the sequence."""
+    def __init__(self, _obj):
+        self._o = _obj
+
+    def __len__(self):
+        return libxml2mod.xmlXPathNodeSetSize(self._o)
+
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            return [self[i] for i in range(*index.indices(len(self)))]
+        if index < 0:
+            index = index + len(self)
+        return nodeWrap(libxml2mod.xmlXPathNodeSetItem(self._o, index))
+
+    def __repr__(self):
+        return "<xpathNodeSet of %d nodes>" % len(self)
+
+#
+# Iterative parsing. The document is read with an xmlTextReader in C,
+# one batch at a time with the GIL released, so only the data returned
+# has to be converted to Python objects.
+#
+_iterparseEvents = { "start": 1, "end": 2, "text": 4 }
+
+def iterparse(source, pattern=None, events=("start", "end"), batch=1000,
+              options=0, namespaces=None):
+    """Parse a file name or a bytes-like object incrementally and
+       yield lists of at most batch items.
+
+       With a pattern (see xmlPatterncompile, namespaces maps prefixes
+       to URIs), the items are copies of the subtrees of the elements
+       matching it. These nodes are freed when the next batch is read,
+       copy them to keep them longer. Nested matches aren't reported.
+
+       Otherwise the items are (event, name, attrs, text) tuples for the
+       requested events: ("start", name, attrs, None) where attrs is a
+       dict or None, ("end", name, None, None) and
+       ("text", None, None, text).
+
+       Nodes which were processed are freed as parsing progresses."""
+    mask = 0
+    for event in events:
+        if event not in _iterparseEvents:
+            raise ValueError("unknown iterparse event %s" % event)
+        mask = mask | _iterparseEvents[event]
+    nsList = None
+    if namespaces is not None:
+        nsList = []
+        for prefix, href in namespaces.items():
+            nsList.append(href)
+            nsList.append(prefix)
+    if isinstance(source, str):
+        it = libxml2mod.xmlIterParseNew(source, None, pattern, nsList,
+                                        mask, options)
+    else:
+        it = libxml2mod.xmlIterParseNew(None, source, pattern, nsList,
+                                        mask, options)
+    if it is None:raise parserError('xmlIterParseNew() failed')
+    while True:
+        ret = libxml2mod.xmlIterParseNext(it, batch)
+        if ret is None:raise parserError('iterparse failed')
+        if not ret:
+            break
+        if pattern is not None:
+            ret = [nodeWrap(node) for node in ret]
+        yield ret
+
 #
 # For the xmlTextReader parser configuration
 #
@@ -281,6 +281,7 @@ PyObject * libxml_xmlParserCtxtPtrWrap(xmlParserCtxtPtr ctxt);
 PyObject * libxml_xmlXPathContextPtrWrap(xmlXPathContextPtr ctxt);
 PyObject * libxml_xmlXPathParserContextPtrWrap(xmlXPathParserContextPtr ctxt);
 PyObject * libxml_xmlXPathObjectPtrWrap(xmlXPathObjectPtr obj);
+PyObject * libxml_xmlXPathNsNodeWrap(xmlNsPtr ns);
 xmlXPathObjectPtr libxml_xmlXPathObjectPtrConvert(PyObject * obj);
 #endif
 PyObject * libxml_xmlValidCtxtPtrWrap(xmlValidCtxtPtr valid);
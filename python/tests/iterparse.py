@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+import sys
+import setup_test
+import libxml2
+
+# Memory debug specific
+libxml2.debugMemory(1)
+
+doc_str = b"""<root xmlns:p="urn:p">
+<item id="1"><name>one</name></item>
+<p:item id="2"><name>two</name></p:item>
+<item id="3"><item id="4"/></item>
+</root>"""
+
+# Events, without blanks
+res = []
+for batch in libxml2.iterparse(doc_str, events=("start", "end", "text"),
+                               batch=3, options=libxml2.XML_PARSE_NOBLANKS):
+    if len(batch) > 3:
+        print("iterparse: batch too large")
+        sys.exit(1)
+    res.extend(batch)
+if res[:4] != [("start", "root", None, None),
+               ("start", "item", {"id": "1"}, None),
+               ("start", "name", None, None),
+               ("text", None, None, "one")]:
+    print("iterparse: unexpected events %s" % res[:4])
+    sys.exit(1)
+if len(res) != 16 or res[-1] != ("end", "root", None, None):
+    print("iterparse: unexpected number of events %d" % len(res))
+    sys.exit(1)
+if ("end", "item", None, None) not in res or \
+   ("start", "p:item", {"id": "2"}, None) not in res:
+    print("iterparse: missing events")
+    sys.exit(1)
+
+# Matching subtrees
+ids = []
+names = []
+for batch in libxml2.iterparse(doc_str, pattern="//item | //q:item",
+                               namespaces={"q": "urn:p"}, batch=2):
+    for node in batch:
+        ids.append(node.prop("id"))
+        names.append(node.xpathEvalStrings("name"))
+if ids != ["1", "2", "3"] or names != [["one"], ["two"], []]:
+    print("iterparse: unexpected matches %s %s" % (ids, names))
+    sys.exit(1)
+
+# Parsing errors are reported
+try:
+    for batch in libxml2.iterparse(b"<a><b></a>", options=libxml2.XML_PARSE_NOERROR):
+        pass
+except libxml2.parserError:
+    pass
+else:
+    print("iterparse: missing parserError")
+    sys.exit(1)
+
+del batch
+del node
+
+# Memory debug specific
+libxml2.cleanupParser()
+if libxml2.debugMemory(1) == 0:
+    print("OK")
+else:
+    print("Memory leak %d bytes" % (libxml2.debugMemory(1)))
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+import sys
+from threading import Thread
+
+import setup_test
+import libxml2
+
+# Memory debug specific
+libxml2.debugMemory(1)
+
+THREADS_COUNT = 8
+
+doc_str = b"<root><a>1</a><a>2</a><a>3</a></root>"
+
+# Any object supporting the buffer protocol is accepted as input
+for data in (doc_str, bytearray(doc_str), memoryview(doc_str)):
+    doc = libxml2.readMemory(data, len(data), None, None, 0)
+    if doc.getRootElement().name != "root":
+        print("FAILED to parse from %s" % type(data).__name__)
+        sys.exit(1)
+    doc.freeDoc()
+
+# Parsing and XPath evaluation run without the GIL, callbacks into
+# Python must still work from several threads at once
+def count(ctxt, nodes):
+    return float(len(nodes))
+
+failed = []
+
+def worker():
+    for i in range(50):
+        doc = libxml2.readMemory(doc_str, len(doc_str), None, None, 0)
+        ctxt = doc.xpathNewContext()
+        libxml2.registerXPathFunction(ctxt._o, "count", "urn:test", count)
+        ctxt.xpathRegisterNs("t", "urn:test")
+        res = ctxt.xpathEval("t:count(//a)")
+        if res != 3:
+            failed.append(res)
+        ctxt.xpathFreeContext()
+        doc.freeDoc()
+
+ts = [Thread(target=worker) for i in range(THREADS_COUNT)]
+for t in ts:
+    t.start()
+for t in ts:
+    t.join()
+
+if failed:
+    print("FAILED: unexpected XPath results %s" % failed[:5])
+    sys.exit(1)
+
+del doc
+del ctxt
+
+# Memory debug specific
+libxml2.cleanupParser()
+if libxml2.debugMemory(1) == 0:
+    print("OK")
+else:
+    print("Memory leak %d bytes" % (libxml2.debugMemory(1)))
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+import sys
+import setup_test
+import libxml2
+
+# Memory debug specific
+libxml2.debugMemory(1)
+
+doc = libxml2.parseDoc(
+    '<r xmlns:p="urn:p"><a id="1" p:x="y">one</a><a id="2">two</a><b/></r>')
+ctxt = doc.xpathNewContext()
+
+res = libxml2.xpathEvalStrings(ctxt, "//a")
+if res != ["one", "two"]:
+    print("xpathEvalStrings: unexpected result %s" % res)
+    sys.exit(1)
+
+res = libxml2.xpathEvalAttrValues(ctxt, "/r/*", "id")
+if res != ["1", "2", None]:
+    print("xpathEvalAttrValues: unexpected result %s" % res)
+    sys.exit(1)
+
+res = libxml2.xpathEvalAttrValues(ctxt, "//a", "x", "urn:p")
+if res != ["y", None]:
+    print("xpathEvalAttrValues: unexpected namespaced result %s" % res)
+    sys.exit(1)
+
+res = libxml2.xpathEvalNameText(ctxt, "//a | //@id")
+if res != [("a", "one"), ("id", "1"), ("a", "two"), ("id", "2")]:
+    print("xpathEvalNameText: unexpected result %s" % res)
+    sys.exit(1)
+
+nodes = libxml2.xpathEvalLazy(ctxt, "/r/* | /r/namespace::*")
+if len(nodes) != 5:
+    print("xpathEvalLazy: wrong node set size %d" % len(nodes))
+    sys.exit(1)
+if [n.name for n in nodes[:3]] != ["a", "a", "b"] or nodes[-1].name != "p":
+    print("xpathEvalLazy: wrong node set content")
+    sys.exit(1)
+try:
+    nodes[5]
+except IndexError:
+    pass
+else:
+    print("xpathEvalLazy: missing IndexError")
+    sys.exit(1)
+
+try:
+    libxml2.xpathEvalStrings(ctxt, "count(//a)")
+except libxml2.xpathError:
+    pass
+else:
+    print("xpathEvalStrings: non node-set result accepted")
+    sys.exit(1)
+
+if doc.getRootElement().xpathEvalStrings("a/@id") != ["1", "2"]:
+    print("xmlNode.xpathEvalStrings: unexpected result")
+    sys.exit(1)
+
+del nodes
+ctxt.xpathFreeContext()
+doc.freeDoc()
+
+# Memory debug specific
+libxml2.cleanupParser()
+if libxml2.debugMemory(1) == 0:
+    print("OK")
+else:
+    print("Memory leak %d bytes" % (libxml2.debugMemory(1)))
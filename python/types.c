@@ -488,6 +488,32 @@ libxml_xmlXPathDestructNsNode(PyObject *cap)
 #endif
 }
 
+/**
+ * libxml_xmlXPathNsNodeWrap:
+ * @ns: a namespace node from an XPath node set
+ *
+ * Wrap a private copy of a namespace node, leaving the node set it was
+ * taken from intact. The copy is released by the capsule destructor.
+ *
+ * Returns the capsule or NULL in case of error
+ */
+PyObject *
+libxml_xmlXPathNsNodeWrap(xmlNsPtr ns)
+{
+    xmlNsPtr copy;
+
+    copy = (xmlNsPtr) xmlMalloc(sizeof(xmlNs));
+    if (copy == NULL)
+        return (PyErr_NoMemory());
+    memset(copy, 0, sizeof(xmlNs));
+    copy->type = XML_NAMESPACE_DECL;
+    copy->href = xmlStrdup(ns->href);
+    copy->prefix = xmlStrdup(ns->prefix);
+    copy->next = ns->next;
+    return (PyCapsule_New((void *) copy, (char *) "xmlNsPtr",
+                          libxml_xmlXPathDestructNsNode));
+}
+
 PyObject *
 libxml_xmlXPathObjectPtrWrap(xmlXPathObjectPtr obj)
 {
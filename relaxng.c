@@ -33,10 +33,15 @@
 #include <libxml/xmlregexp.h>
 #include <libxml/xmlschemastypes.h>
 
+#include "private/buf.h"
 #include "private/error.h"
+#include "private/io.h"
+#include "private/memory.h"
 #include "private/regexp.h"
+#include "private/schemas.h"
 #include "private/string.h"
 #include "private/threads.h"
+#include "private/trace.h"
 
 /*
  * The Relax-NG namespace
@@ -127,6 +132,9 @@ typedef enum {
 #define IS_COMPILABLE		(1 << 6)
 #define IS_NOT_COMPILABLE	(1 << 7)
 #define IS_EXTERNAL_REF	        (1 << 8)
+#define IS_DATA_CONTENT		(1 << 9)
+#define IS_ATTRS_ONLY		(1 << 10)
+#define HAS_CONTENT_ATTRS	(1 << 11)
 
 struct _xmlRelaxNGDefine {
     xmlRelaxNGType type;        /* the type of definition */
@@ -144,6 +152,7 @@ struct _xmlRelaxNGDefine {
     short depth;                /* used for the cycle detection */
     short dflags;               /* define related flags */
     xmlRegexpPtr contModel;     /* a compiled content model if available */
+    void *compiled;             /* a compiled datatype if available */
 };
 
 /**
@@ -281,6 +290,17 @@ struct _xmlRelaxNGValidState {
     xmlAttrPtr *attrs;          /* the array of attributes */
 };
 
+/*
+ * Containers with at least that many states look up duplicates
+ * in a hash table
+ */
+#define MIN_HASHED_STATES 8
+
+typedef struct {
+    unsigned hashValue;
+    int index;                  /* index in tabState plus one, 0 if free */
+} xmlRelaxNGStateSlot;
+
 /**
  * A RelaxNGs container for validation state
  */
@@ -290,6 +310,14 @@ struct _xmlRelaxNGStates {
     int nbState;                /* the number of states */
     int maxState;               /* the size of the array */
     xmlRelaxNGValidStatePtr *tabState;
+    /*
+     * The hash table indexes the first nbHashed states. It's rebuilt
+     * if nbHashed doesn't match nbState, so code modifying states
+     * in place must set nbHashed to -1.
+     */
+    xmlRelaxNGStateSlot *hashTab;
+    int hashSize;               /* the size of hashTab, a power of two */
+    int nbHashed;
 };
 
 #define ERROR_IS_DUP	1
@@ -308,6 +336,9 @@ struct _xmlRelaxNGValidError {
     const xmlChar *arg2;        /* second arg */
 };
 
+typedef struct _xmlRelaxNGDeriv xmlRelaxNGDeriv;
+typedef xmlRelaxNGDeriv *xmlRelaxNGDerivPtr;
+
 /**
  * A RelaxNGs validation context
  */
@@ -355,6 +386,13 @@ struct _xmlRelaxNGValidCtxt {
     xmlRelaxNGDefinePtr pdef;   /* the non-streamable definition */
     int perr;                   /* signal error in content model
                                  * outside the regexp */
+    xmlRelaxNGDefinePtr pdata;  /* the current element with data content */
+    xmlChar *pvalue;            /* the text of that element */
+
+    int derivatives;            /* validate with pattern derivatives */
+    xmlRelaxNGDerivPtr deriv;   /* patterns and memoized derivatives */
+    xmlErrorPolicy *errorPolicy; /* limits on reported errors */
+    xmlRegExecPoolPtr execPool; /* regexp contexts for reuse */
 };
 
 /**
@@ -569,6 +607,42 @@ typedef int (*xmlRelaxNGFacetCheck) (void *data, const xmlChar * type,
  */
 typedef void (*xmlRelaxNGTypeFree) (void *data, void *result);
 
+/**
+ * Function provided by a type library to compile a type and its
+ * parameters once, at grammar parsing time
+ *
+ * @param data  data needed for the library
+ * @param type  the type name
+ * @param params  the list of param definitions
+ * @returns the compiled type or NULL if it can't be compiled.
+ */
+typedef void *(*xmlRelaxNGTypeCompile) (void *data, const xmlChar * type,
+                                        xmlRelaxNGDefinePtr params);
+
+/**
+ * Function provided by a type library to check a value against
+ * a compiled type and its parameters
+ *
+ * @param data  data needed for the library
+ * @param comp  the compiled type
+ * @param value  the value to check
+ * @param node  the node
+ * @returns 1 if the value matches, 0 if it doesn't match the type,
+ * 2 for an ID error, 3 if a parameter rejects it and -1 in case
+ * of error.
+ */
+typedef int (*xmlRelaxNGTypeValidate) (void *data, void *comp,
+                                       const xmlChar * value,
+                                       xmlNode *node);
+
+/**
+ * Function provided by a type library to free a compiled type
+ *
+ * @param data  data needed for the library
+ * @param comp  the compiled type
+ */
+typedef void (*xmlRelaxNGTypeFreeComp) (void *data, void *comp);
+
 /**
  * Function provided by a type library to compare two values accordingly
  * to a type.
@@ -595,6 +669,9 @@ struct _xmlRelaxNGTypeLibrary {
     xmlRelaxNGTypeCompare comp; /* the compare function */
     xmlRelaxNGFacetCheck facet; /* the facet check function */
     xmlRelaxNGTypeFree freef;   /* the freeing function */
+    xmlRelaxNGTypeCompile compile;      /* the type compile function */
+    xmlRelaxNGTypeValidate validate;    /* the compiled check function */
+    xmlRelaxNGTypeFreeComp freec;       /* frees compiled types */
 };
 
 /************************************************************************
@@ -907,6 +984,14 @@ xmlRelaxNGFreeDefine(xmlRelaxNGDefinePtr define)
         if ((lib != NULL) && (lib->freef != NULL))
             lib->freef(lib->data, (void *) define->attrs);
     }
+    if ((define->type == XML_RELAXNG_DATATYPE) &&
+        (define->compiled != NULL)) {
+        xmlRelaxNGTypeLibraryPtr lib;
+
+        lib = (xmlRelaxNGTypeLibraryPtr) define->data;
+        if ((lib != NULL) && (lib->freec != NULL))
+            lib->freec(lib->data, define->compiled);
+    }
     if ((define->data != NULL) && (define->type == XML_RELAXNG_INTERLEAVE))
         xmlRelaxNGFreePartition((xmlRelaxNGPartitionPtr) define->data);
     if ((define->data != NULL) && (define->type == XML_RELAXNG_CHOICE))
@@ -939,6 +1024,7 @@ xmlRelaxNGNewStates(xmlRelaxNGValidCtxtPtr ctxt, int size)
         ctxt->freeStatesNr--;
         ret = ctxt->freeStates[ctxt->freeStatesNr];
         ret->nbState = 0;
+        ret->nbHashed = -1;
         return (ret);
     }
     if (size < 16)
@@ -954,6 +1040,9 @@ xmlRelaxNGNewStates(xmlRelaxNGValidCtxtPtr ctxt, int size)
     }
     ret->nbState = 0;
     ret->maxState = size;
+    ret->hashTab = NULL;
+    ret->hashSize = 0;
+    ret->nbHashed = 0;
     ret->tabState = (xmlRelaxNGValidStatePtr *) xmlMalloc((size) *
                                                           sizeof
                                                           (xmlRelaxNGValidStatePtr));
@@ -1002,6 +1091,102 @@ xmlRelaxNGAddStatesUniq(xmlRelaxNGValidCtxtPtr ctxt,
     return (1);
 }
 
+/**
+ * Compute a hash value of a validation state consistent with
+ * xmlRelaxNGEqualValidState.
+ *
+ * @param state  a validation state
+ * @returns the hash value
+ */
+static unsigned
+xmlRelaxNGHashValidState(xmlRelaxNGValidStatePtr state)
+{
+    unsigned h = 0x811C9DC5u;
+    const xmlChar *cur;
+    int i;
+
+#define HASH_MIX(v) h = (h ^ (unsigned) (v)) * 0x01000193u
+    HASH_MIX((size_t) state->node);
+    HASH_MIX((size_t) state->seq);
+    HASH_MIX((size_t) state->endvalue);
+    HASH_MIX(state->nbAttrLeft);
+    HASH_MIX(state->nbAttrs);
+    for (i = 0; i < state->nbAttrs; i++)
+        HASH_MIX((size_t) state->attrs[i]);
+    if (state->value != NULL) {
+        for (cur = state->value; *cur != 0; cur++)
+            HASH_MIX(*cur);
+    }
+#undef HASH_MIX
+
+    return (h ^ (h >> 15));
+}
+
+/**
+ * Insert the state at `index` in the hash table of the container
+ * which must have room for it.
+ *
+ * @param states  the states container
+ * @param index  the index of the state
+ * @param hashValue  the hash value of the state
+ */
+static void
+xmlRelaxNGHashStates(xmlRelaxNGStatesPtr states, int index,
+                     unsigned hashValue)
+{
+    unsigned mask = states->hashSize - 1;
+    unsigned pos = hashValue & mask;
+
+    while (states->hashTab[pos].index != 0)
+        pos = (pos + 1) & mask;
+    states->hashTab[pos].hashValue = hashValue;
+    states->hashTab[pos].index = index + 1;
+    states->nbHashed++;
+}
+
+/**
+ * Rebuild the hash table of a container with room for one more
+ * state.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param states  the states container
+ * @returns 0 in case of success and -1 on error
+ */
+static int
+xmlRelaxNGRehashStates(xmlRelaxNGValidCtxtPtr ctxt,
+                       xmlRelaxNGStatesPtr states)
+{
+    int size, i;
+
+    /* Keep the load factor at or below one half */
+    size = states->hashSize;
+    if (size < 32)
+        size = 32;
+    while (size < 2 * (states->nbState + 1))
+        size *= 2;
+    if (size != states->hashSize) {
+        xmlRelaxNGStateSlot *tmp;
+
+        tmp = xmlRealloc(states->hashTab, size * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlRngVErrMemory(ctxt);
+            return (-1);
+        }
+        states->hashTab = tmp;
+        states->hashSize = size;
+    }
+    memset(states->hashTab, 0, size * sizeof(states->hashTab[0]));
+    states->nbHashed = 0;
+    for (i = 0; i < states->nbState; i++) {
+        if (states->tabState[i] != NULL)
+            xmlRelaxNGHashStates(states, i,
+                    xmlRelaxNGHashValidState(states->tabState[i]));
+    }
+    states->nbHashed = states->nbState;
+
+    return (0);
+}
+
 /**
  * Add a RelaxNG validation state to the container
  *
@@ -1036,6 +1221,29 @@ xmlRelaxNGAddStates(xmlRelaxNGValidCtxtPtr ctxt,
         states->tabState = tmp;
         states->maxState = size;
     }
+    if (states->nbState >= MIN_HASHED_STATES) {
+        unsigned hashValue, mask, pos;
+
+        if (((states->nbHashed != states->nbState) ||
+             (2 * (states->nbState + 1) > states->hashSize)) &&
+            (xmlRelaxNGRehashStates(ctxt, states) < 0))
+            return (-1);
+
+        hashValue = xmlRelaxNGHashValidState(state);
+        mask = states->hashSize - 1;
+        for (pos = hashValue & mask; states->hashTab[pos].index != 0;
+             pos = (pos + 1) & mask) {
+            if ((states->hashTab[pos].hashValue == hashValue) &&
+                (xmlRelaxNGEqualValidState(ctxt, state,
+                     states->tabState[states->hashTab[pos].index - 1]))) {
+                xmlRelaxNGFreeValidState(ctxt, state);
+                return (0);
+            }
+        }
+        xmlRelaxNGHashStates(states, states->nbState, hashValue);
+        states->tabState[states->nbState++] = state;
+        return (1);
+    }
     for (i = 0; i < states->nbState; i++) {
         if (xmlRelaxNGEqualValidState(ctxt, state, states->tabState[i])) {
             xmlRelaxNGFreeValidState(ctxt, state);
@@ -1076,6 +1284,7 @@ xmlRelaxNGFreeStates(xmlRelaxNGValidCtxtPtr ctxt,
                                                  (xmlRelaxNGStatesPtr));
         if (tmp == NULL) {
             xmlRngVErrMemory(ctxt);
+            xmlFree(states->hashTab);
             xmlFree(states->tabState);
             xmlFree(states);
             return;
@@ -1084,6 +1293,7 @@ xmlRelaxNGFreeStates(xmlRelaxNGValidCtxtPtr ctxt,
         ctxt->freeStatesMax *= 2;
     }
     if ((ctxt == NULL) || (ctxt->freeStates == NULL)) {
+        xmlFree(states->hashTab);
         xmlFree(states->tabState);
         xmlFree(states);
     } else {
@@ -2156,6 +2366,19 @@ xmlRelaxNGShowValidError(xmlRelaxNGValidCtxtPtr ctxt,
     if (ctxt->flags & FLAGS_NOERROR)
         return;
 
+    if (ctxt->errorPolicy != NULL) {
+        xmlNodePtr cur = (child == NULL ? node : child);
+
+        if (!xmlErrorPolicyCheck(ctxt->errorPolicy, err,
+                                 cur ? (int) cur->type : 0,
+                                 XML_ERR_ERROR)) {
+            if (ctxt->errNo == XML_RELAXNG_OK)
+                ctxt->errNo = err;
+            ctxt->nbErrors++;
+            return;
+        }
+    }
+
     msg = xmlRelaxNGGetErrorString(err, arg1, arg2);
     if (msg == NULL)
         return;
@@ -2358,6 +2581,42 @@ xmlRelaxNGSchemaTypeCheck(void *data ATTRIBUTE_UNUSED,
     return (-1);
 }
 
+/**
+ * Map a param name to the matching XML Schema facet type
+ *
+ * @param facetname  the facet name
+ * @returns the facet type or -1 if the name isn't a facet.
+ */
+static int
+xmlRelaxNGSchemaFacetType(const xmlChar * facetname)
+{
+    if (xmlStrEqual(facetname, BAD_CAST "minInclusive"))
+        return (XML_SCHEMA_FACET_MININCLUSIVE);
+    if (xmlStrEqual(facetname, BAD_CAST "minExclusive"))
+        return (XML_SCHEMA_FACET_MINEXCLUSIVE);
+    if (xmlStrEqual(facetname, BAD_CAST "maxInclusive"))
+        return (XML_SCHEMA_FACET_MAXINCLUSIVE);
+    if (xmlStrEqual(facetname, BAD_CAST "maxExclusive"))
+        return (XML_SCHEMA_FACET_MAXEXCLUSIVE);
+    if (xmlStrEqual(facetname, BAD_CAST "totalDigits"))
+        return (XML_SCHEMA_FACET_TOTALDIGITS);
+    if (xmlStrEqual(facetname, BAD_CAST "fractionDigits"))
+        return (XML_SCHEMA_FACET_FRACTIONDIGITS);
+    if (xmlStrEqual(facetname, BAD_CAST "pattern"))
+        return (XML_SCHEMA_FACET_PATTERN);
+    if (xmlStrEqual(facetname, BAD_CAST "enumeration"))
+        return (XML_SCHEMA_FACET_ENUMERATION);
+    if (xmlStrEqual(facetname, BAD_CAST "whiteSpace"))
+        return (XML_SCHEMA_FACET_WHITESPACE);
+    if (xmlStrEqual(facetname, BAD_CAST "length"))
+        return (XML_SCHEMA_FACET_LENGTH);
+    if (xmlStrEqual(facetname, BAD_CAST "maxLength"))
+        return (XML_SCHEMA_FACET_MAXLENGTH);
+    if (xmlStrEqual(facetname, BAD_CAST "minLength"))
+        return (XML_SCHEMA_FACET_MINLENGTH);
+    return (-1);
+}
+
 /**
  * Function provided by a type library to check a value facet
  *
@@ -2377,7 +2636,7 @@ xmlRelaxNGSchemaFacetCheck(void *data ATTRIBUTE_UNUSED,
 {
     xmlSchemaFacetPtr facet;
     xmlSchemaTypePtr typ;
-    int ret;
+    int ret, ftype;
 
     if ((type == NULL) || (strval == NULL))
         return (-1);
@@ -2387,38 +2646,13 @@ xmlRelaxNGSchemaFacetCheck(void *data ATTRIBUTE_UNUSED,
     if (typ == NULL)
         return (-1);
 
+    ftype = xmlRelaxNGSchemaFacetType(facetname);
+    if (ftype < 0)
+        return (-1);
     facet = xmlSchemaNewFacet();
     if (facet == NULL)
         return (-1);
-
-    if (xmlStrEqual(facetname, BAD_CAST "minInclusive")) {
-        facet->type = XML_SCHEMA_FACET_MININCLUSIVE;
-    } else if (xmlStrEqual(facetname, BAD_CAST "minExclusive")) {
-        facet->type = XML_SCHEMA_FACET_MINEXCLUSIVE;
-    } else if (xmlStrEqual(facetname, BAD_CAST "maxInclusive")) {
-        facet->type = XML_SCHEMA_FACET_MAXINCLUSIVE;
-    } else if (xmlStrEqual(facetname, BAD_CAST "maxExclusive")) {
-        facet->type = XML_SCHEMA_FACET_MAXEXCLUSIVE;
-    } else if (xmlStrEqual(facetname, BAD_CAST "totalDigits")) {
-        facet->type = XML_SCHEMA_FACET_TOTALDIGITS;
-    } else if (xmlStrEqual(facetname, BAD_CAST "fractionDigits")) {
-        facet->type = XML_SCHEMA_FACET_FRACTIONDIGITS;
-    } else if (xmlStrEqual(facetname, BAD_CAST "pattern")) {
-        facet->type = XML_SCHEMA_FACET_PATTERN;
-    } else if (xmlStrEqual(facetname, BAD_CAST "enumeration")) {
-        facet->type = XML_SCHEMA_FACET_ENUMERATION;
-    } else if (xmlStrEqual(facetname, BAD_CAST "whiteSpace")) {
-        facet->type = XML_SCHEMA_FACET_WHITESPACE;
-    } else if (xmlStrEqual(facetname, BAD_CAST "length")) {
-        facet->type = XML_SCHEMA_FACET_LENGTH;
-    } else if (xmlStrEqual(facetname, BAD_CAST "maxLength")) {
-        facet->type = XML_SCHEMA_FACET_MAXLENGTH;
-    } else if (xmlStrEqual(facetname, BAD_CAST "minLength")) {
-        facet->type = XML_SCHEMA_FACET_MINLENGTH;
-    } else {
-        xmlSchemaFreeFacet(facet);
-        return (-1);
-    }
+    facet->type = (xmlSchemaTypeType) ftype;
     facet->value = val;
     ret = xmlSchemaCheckFacet(facet, typ, NULL, type);
     if (ret != 0) {
@@ -2432,6 +2666,154 @@ xmlRelaxNGSchemaFacetCheck(void *data ATTRIBUTE_UNUSED,
     return (0);
 }
 
+/**
+ * A W3C XMLSchema datatype with its params compiled to facets
+ */
+typedef struct _xmlRelaxNGSchemaCompType xmlRelaxNGSchemaCompType;
+typedef xmlRelaxNGSchemaCompType *xmlRelaxNGSchemaCompTypePtr;
+struct _xmlRelaxNGSchemaCompType {
+    xmlSchemaTypePtr type;      /* the predefined type */
+    int invalid;                /* a param was rejected */
+    int nbFacets;               /* number of facets */
+    xmlSchemaFacetPtr *facets;  /* the checked facets */
+};
+
+/**
+ * Free a compiled W3C XMLSchema datatype
+ *
+ * @param data  data needed for the library
+ * @param comp  the compiled type
+ */
+static void
+xmlRelaxNGSchemaFreeComp(void *data ATTRIBUTE_UNUSED, void *comp)
+{
+    xmlRelaxNGSchemaCompTypePtr ctype = comp;
+    int i;
+
+    if (ctype == NULL)
+        return;
+    for (i = 0; i < ctype->nbFacets; i++)
+        xmlSchemaFreeFacet(ctype->facets[i]);
+    if (ctype->facets != NULL)
+        xmlFree(ctype->facets);
+    xmlFree(ctype);
+}
+
+/**
+ * Resolve a W3C XMLSchema datatype and build and check the facets
+ * of its params, so that values are validated without any setup.
+ *
+ * @param data  data needed for the library
+ * @param type  the type name
+ * @param params  the list of param definitions
+ * @returns the compiled type or NULL if it can't be compiled.
+ */
+static void *
+xmlRelaxNGSchemaTypeCompile(void *data ATTRIBUTE_UNUSED,
+                            const xmlChar * type,
+                            xmlRelaxNGDefinePtr params)
+{
+    xmlRelaxNGSchemaCompTypePtr ret;
+    xmlRelaxNGDefinePtr cur;
+    xmlSchemaFacetPtr facet;
+    int nb = 0, ftype;
+
+    if (type == NULL)
+        return (NULL);
+    for (cur = params; (cur != NULL) && (cur->type == XML_RELAXNG_PARAM);
+         cur = cur->next)
+        nb++;
+
+    ret = xmlMalloc(sizeof(xmlRelaxNGSchemaCompType));
+    if (ret == NULL)
+        return (NULL);
+    memset(ret, 0, sizeof(xmlRelaxNGSchemaCompType));
+    ret->type = xmlSchemaGetPredefinedType(type,
+                                           BAD_CAST
+                                           "http://www.w3.org/2001/XMLSchema");
+    if (ret->type == NULL)
+        goto error;
+    if (nb > 0) {
+        ret->facets = xmlMalloc(nb * sizeof(xmlSchemaFacetPtr));
+        if (ret->facets == NULL)
+            goto error;
+    }
+
+    /*
+     * A param which isn't a valid facet rejects every value, like
+     * the facet check function does.
+     */
+    for (cur = params; (cur != NULL) && (cur->type == XML_RELAXNG_PARAM);
+         cur = cur->next) {
+        ftype = xmlRelaxNGSchemaFacetType(cur->name);
+        if ((ftype < 0) || (cur->value == NULL)) {
+            ret->invalid = 1;
+            break;
+        }
+        facet = xmlSchemaNewFacet();
+        if (facet == NULL)
+            goto error;
+        facet->type = (xmlSchemaTypeType) ftype;
+        facet->value = cur->value;
+        ret->facets[ret->nbFacets++] = facet;
+        if (xmlSchemaCheckFacet(facet, ret->type, NULL, type) != 0) {
+            ret->invalid = 1;
+            break;
+        }
+    }
+    return (ret);
+
+error:
+    xmlRelaxNGSchemaFreeComp(NULL, ret);
+    return (NULL);
+}
+
+/**
+ * Check a value against a compiled W3C XMLSchema datatype
+ *
+ * @param data  data needed for the library
+ * @param comp  the compiled type
+ * @param value  the value to check
+ * @param node  the node
+ * @returns 1 if the value matches, 0 if it doesn't match the type,
+ * 2 for an ID error, 3 if a facet rejects it and -1 in case of error.
+ */
+static int
+xmlRelaxNGSchemaTypeValidate(void *data ATTRIBUTE_UNUSED, void *comp,
+                             const xmlChar * value, xmlNodePtr node)
+{
+    xmlRelaxNGSchemaCompTypePtr ctype = comp;
+    xmlSchemaValPtr result = NULL;
+    int ret, i;
+
+    if ((ctype == NULL) || (value == NULL))
+        return (-1);
+    ret = xmlSchemaValPredefTypeNode(ctype->type, value,
+                                     ctype->nbFacets > 0 ? &result : NULL,
+                                     node);
+    if (ret == 2) {             /* special ID error code */
+        ret = 2;
+    } else if (ret > 0) {
+        ret = 0;
+    } else if (ret < 0) {
+        ret = -1;
+    } else if (ctype->invalid) {
+        ret = 3;
+    } else {
+        ret = 1;
+        for (i = 0; i < ctype->nbFacets; i++) {
+            if (xmlSchemaValidateFacet(ctype->type, ctype->facets[i],
+                                       value, result) != 0) {
+                ret = 3;
+                break;
+            }
+        }
+    }
+    if (result != NULL)
+        xmlSchemaFreeValue(result);
+    return (ret);
+}
+
 /**
  * Function provided by a type library to free a Schemas value
  *
@@ -2637,6 +3019,9 @@ xmlRelaxNGFreeTypeLibrary(void *payload,
  * @param comp  the comparison function
  * @param facet  facet check function
  * @param freef  free function
+ * @param compile  type compile function, optional
+ * @param validate  compiled type check function, optional
+ * @param freec  compiled type free function, optional
  * @returns 0 in case of success and -1 in case of error.
  */
 static int
@@ -2645,7 +3030,10 @@ xmlRelaxNGRegisterTypeLibrary(const xmlChar * namespace, void *data,
                               xmlRelaxNGTypeCheck check,
                               xmlRelaxNGTypeCompare comp,
                               xmlRelaxNGFacetCheck facet,
-                              xmlRelaxNGTypeFree freef)
+                              xmlRelaxNGTypeFree freef,
+                              xmlRelaxNGTypeCompile compile,
+                              xmlRelaxNGTypeValidate validate,
+                              xmlRelaxNGTypeFreeComp freec)
 {
     xmlRelaxNGTypeLibraryPtr lib;
     int ret;
@@ -2670,6 +3058,9 @@ xmlRelaxNGRegisterTypeLibrary(const xmlChar * namespace, void *data,
     lib->check = check;
     lib->facet = facet;
     lib->freef = freef;
+    lib->compile = compile;
+    lib->validate = validate;
+    lib->freec = freec;
     ret = xmlHashAddEntry(xmlRelaxNGRegisteredTypes, namespace, lib);
     if (ret < 0) {
         xmlRelaxNGFreeTypeLibrary(lib, namespace);
@@ -2719,12 +3110,15 @@ xmlRelaxNGInitTypes(void)
                                   xmlRelaxNGSchemaTypeCheck,
                                   xmlRelaxNGSchemaTypeCompare,
                                   xmlRelaxNGSchemaFacetCheck,
-                                  xmlRelaxNGSchemaFreeValue);
+                                  xmlRelaxNGSchemaFreeValue,
+                                  xmlRelaxNGSchemaTypeCompile,
+                                  xmlRelaxNGSchemaTypeValidate,
+                                  xmlRelaxNGSchemaFreeComp);
     xmlRelaxNGRegisterTypeLibrary(xmlRelaxNGNs, NULL,
                                   xmlRelaxNGDefaultTypeHave,
                                   xmlRelaxNGDefaultTypeCheck,
                                   xmlRelaxNGDefaultTypeCompare, NULL,
-                                  NULL);
+                                  NULL, NULL, NULL, NULL);
     xmlRelaxNGTypeInitialized = 1;
     xmlMutexUnlock(&xmlRelaxNGMutex);
     return (0);
@@ -2764,6 +3158,167 @@ xmlRelaxNGCleanupTypes(void)
 
 static int xmlRelaxNGTryCompile(xmlRelaxNGParserCtxtPtr ctxt,
                                 xmlRelaxNGDefinePtr def);
+static int xmlRelaxNGIsCompilable(xmlRelaxNGDefinePtr def);
+static int xmlRelaxNGCompile(xmlRelaxNGParserCtxtPtr ctxt,
+                             xmlRelaxNGDefinePtr def);
+
+/*
+ * Interleaves are compiled with one state per set of elements already
+ * seen, this limits the number of elements which can't repeat
+ */
+#define MAX_COMPILED_INTERLEAVE 8
+
+/**
+ * Find the element or text an item of an interleave repeats.
+ *
+ * @param def  the interleave item
+ * @param min  the minimum number of occurrences
+ * @param max  the maximum number of occurrences, -1 if unbounded
+ * @returns the element or text definition or NULL if the item isn't
+ *         a simple repetition of a named element or text
+ */
+static xmlRelaxNGDefinePtr
+xmlRelaxNGInterleaveItem(xmlRelaxNGDefinePtr def, int *min, int *max)
+{
+    *min = 1;
+    *max = 1;
+    while (def != NULL) {
+        switch (def->type) {
+            case XML_RELAXNG_NOOP:
+            case XML_RELAXNG_REF:
+            case XML_RELAXNG_EXTERNALREF:
+            case XML_RELAXNG_PARENTREF:
+            case XML_RELAXNG_DEF:
+            case XML_RELAXNG_GROUP:
+                break;
+            case XML_RELAXNG_OPTIONAL:
+            case XML_RELAXNG_ZEROORMORE:
+            case XML_RELAXNG_ONEORMORE:
+                if (def->type != XML_RELAXNG_ONEORMORE)
+                    *min = 0;
+                if (def->type != XML_RELAXNG_OPTIONAL)
+                    *max = -1;
+                break;
+            case XML_RELAXNG_ELEMENT:
+                if ((def->name == NULL) || (def->nameClass != NULL))
+                    return (NULL);
+                return (def);
+            case XML_RELAXNG_TEXT:
+                *min = 0;
+                *max = -1;
+                return (def);
+            default:
+                return (NULL);
+        }
+        if ((def->content == NULL) || (def->content->next != NULL))
+            return (NULL);
+        def = def->content;
+    }
+    return (NULL);
+}
+
+/**
+ * Check if an interleave can be compiled: its items must be
+ * repetitions of distinct named elements or text, with at most
+ * MAX_COMPILED_INTERLEAVE elements which can't repeat or are required.
+ *
+ * @param def  the interleave definition
+ * @returns 1 if yes, 0 if no
+ */
+static int
+xmlRelaxNGIsCompilableInterleave(xmlRelaxNGDefinePtr def)
+{
+    xmlRelaxNGDefinePtr cur, prev, item, other;
+    int min, max, omin, omax, nbTracked = 0;
+
+    for (cur = def->content; cur != NULL; cur = cur->next) {
+        item = xmlRelaxNGInterleaveItem(cur, &min, &max);
+        if (item == NULL)
+            return (0);
+        if (item->type != XML_RELAXNG_ELEMENT)
+            continue;
+        if (xmlRelaxNGIsCompilable(item) != 1)
+            return (0);
+        for (prev = def->content; prev != cur; prev = prev->next) {
+            other = xmlRelaxNGInterleaveItem(prev, &omin, &omax);
+            if ((other->type == XML_RELAXNG_ELEMENT) &&
+                (xmlStrEqual(other->name, item->name)) &&
+                (xmlStrEqual(other->ns, item->ns)))
+                return (0);
+        }
+        if ((min == 1) || (max == 1))
+            nbTracked++;
+    }
+    if (nbTracked > MAX_COMPILED_INTERLEAVE)
+        return (0);
+    return (1);
+}
+
+/**
+ * Check if a list of definitions is compilable and collect whether
+ * it only generates attributes or contains attributes which can be
+ * validated separately from the content model.
+ *
+ * @param list  the list of definitions
+ * @param flags  the IS_ATTRS_ONLY and HAS_CONTENT_ATTRS flags
+ * @returns 1 if yes, 0 if no and -1 in case of error
+ */
+static int
+xmlRelaxNGIsCompilableList(xmlRelaxNGDefinePtr list, int *flags)
+{
+    int ret = 1;
+
+    *flags = (list != NULL) ? IS_ATTRS_ONLY : 0;
+    while (list != NULL) {
+        ret = xmlRelaxNGIsCompilable(list);
+        if (ret != 1)
+            return (ret);
+        if (list->type == XML_RELAXNG_ELEMENT) {
+            *flags &= ~IS_ATTRS_ONLY;
+        } else {
+            if (((list->dflags & IS_ATTRS_ONLY) == 0) &&
+                (list->type != XML_RELAXNG_EMPTY))
+                *flags &= ~IS_ATTRS_ONLY;
+            if (list->dflags & HAS_CONTENT_ATTRS)
+                *flags |= HAS_CONTENT_ATTRS;
+        }
+        list = list->next;
+    }
+    return (ret);
+}
+
+/**
+ * Check if a list of definitions only matches text and data, which
+ * is then validated as a whole.
+ *
+ * @param list  the list of definitions
+ * @returns 1 if yes, 0 if no
+ */
+static int
+xmlRelaxNGIsDataContent(xmlRelaxNGDefinePtr list)
+{
+    if (list == NULL)
+        return (0);
+    while (list != NULL) {
+        switch (list->type) {
+            case XML_RELAXNG_DATATYPE:
+            case XML_RELAXNG_VALUE:
+            case XML_RELAXNG_LIST:
+                break;
+            case XML_RELAXNG_CHOICE:
+            case XML_RELAXNG_DEF:
+            case XML_RELAXNG_REF:
+            case XML_RELAXNG_PARENTREF:
+                if (!xmlRelaxNGIsDataContent(list->content))
+                    return (0);
+                break;
+            default:
+                return (0);
+        }
+        list = list->next;
+    }
+    return (1);
+}
 
 /**
  * Check if a definition is nullable.
@@ -2775,6 +3330,7 @@ static int
 xmlRelaxNGIsCompilable(xmlRelaxNGDefinePtr def)
 {
     int ret = -1;
+    int flags = 0;
 
     if (def == NULL) {
         return (-1);
@@ -2786,9 +3342,6 @@ xmlRelaxNGIsCompilable(xmlRelaxNGDefinePtr def)
         (def->dflags & IS_NOT_COMPILABLE))
         return (0);
     switch (def->type) {
-        case XML_RELAXNG_NOOP:
-            ret = xmlRelaxNGIsCompilable(def->content);
-            break;
         case XML_RELAXNG_TEXT:
         case XML_RELAXNG_EMPTY:
             ret = 1;
@@ -2799,14 +3352,14 @@ xmlRelaxNGIsCompilable(xmlRelaxNGDefinePtr def)
              */
             if (((def->dflags & IS_NOT_COMPILABLE) == 0) &&
                 ((def->dflags & IS_COMPILABLE) == 0)) {
-                xmlRelaxNGDefinePtr list;
-
-                list = def->content;
-                while (list != NULL) {
-                    ret = xmlRelaxNGIsCompilable(list);
-                    if (ret != 1)
-                        break;
-                    list = list->next;
+                if (xmlRelaxNGIsDataContent(def->content)) {
+                    /*
+                     * The text is validated at the end of the element
+                     */
+                    ret = 1;
+                    def->dflags |= IS_DATA_CONTENT;
+                } else {
+                    ret = xmlRelaxNGIsCompilableList(def->content, &flags);
                 }
 		/*
 		 * Because the routine is recursive, we must guard against
@@ -2816,8 +3369,11 @@ xmlRelaxNGIsCompilable(xmlRelaxNGDefinePtr def)
 		    def->dflags &= ~IS_COMPILABLE;
                     def->dflags |= IS_NOT_COMPILABLE;
 		}
-                if ((ret == 1) && !(def->dflags &= IS_NOT_COMPILABLE))
+                if ((ret == 1) && !(def->dflags & IS_NOT_COMPILABLE)) {
                     def->dflags |= IS_COMPILABLE;
+                    if (flags & HAS_CONTENT_ATTRS)
+                        def->dflags |= HAS_CONTENT_ATTRS;
+                }
             }
             /*
              * All elements return a compilable status unless they
@@ -2828,45 +3384,49 @@ xmlRelaxNGIsCompilable(xmlRelaxNGDefinePtr def)
             else
                 ret = 1;
             return (ret);
+        case XML_RELAXNG_ATTRIBUTE:
+            /*
+             * Attributes are validated separately from the content
+             * model when they're not part of a choice or repetition
+             * involving other content
+             */
+            ret = 1;
+            flags = IS_ATTRS_ONLY | HAS_CONTENT_ATTRS;
+            break;
         case XML_RELAXNG_REF:
         case XML_RELAXNG_EXTERNALREF:
         case XML_RELAXNG_PARENTREF:
             if (def->depth == -20) {
                 return (1);
             } else {
-                xmlRelaxNGDefinePtr list;
-
                 def->depth = -20;
-                list = def->content;
-                while (list != NULL) {
-                    ret = xmlRelaxNGIsCompilable(list);
-                    if (ret != 1)
-                        break;
-                    list = list->next;
-                }
+                ret = xmlRelaxNGIsCompilableList(def->content, &flags);
             }
             break;
+        case XML_RELAXNG_NOOP:
+        case XML_RELAXNG_GROUP:
+        case XML_RELAXNG_DEF:
+            ret = xmlRelaxNGIsCompilableList(def->content, &flags);
+            break;
         case XML_RELAXNG_START:
         case XML_RELAXNG_OPTIONAL:
         case XML_RELAXNG_ZEROORMORE:
         case XML_RELAXNG_ONEORMORE:
         case XML_RELAXNG_CHOICE:
-        case XML_RELAXNG_GROUP:
-        case XML_RELAXNG_DEF:{
-                xmlRelaxNGDefinePtr list;
-
-                list = def->content;
-                while (list != NULL) {
-                    ret = xmlRelaxNGIsCompilable(list);
-                    if (ret != 1)
-                        break;
-                    list = list->next;
-                }
-                break;
+            ret = xmlRelaxNGIsCompilableList(def->content, &flags);
+            if ((ret == 1) && (flags & HAS_CONTENT_ATTRS) &&
+                (((flags & IS_ATTRS_ONLY) == 0) ||
+                 (def->type == XML_RELAXNG_START)))
+                ret = 0;
+            break;
+        case XML_RELAXNG_INTERLEAVE:
+            ret = xmlRelaxNGIsCompilableList(def->content, &flags);
+            if ((ret != 1) || ((flags & IS_ATTRS_ONLY) == 0)) {
+                flags = 0;
+                ret = xmlRelaxNGIsCompilableInterleave(def);
             }
+            break;
         case XML_RELAXNG_EXCEPT:
-        case XML_RELAXNG_ATTRIBUTE:
-        case XML_RELAXNG_INTERLEAVE:
         case XML_RELAXNG_DATATYPE:
         case XML_RELAXNG_LIST:
         case XML_RELAXNG_PARAM:
@@ -2878,10 +3438,94 @@ xmlRelaxNGIsCompilable(xmlRelaxNGDefinePtr def)
     if (ret == 0)
         def->dflags |= IS_NOT_COMPILABLE;
     if (ret == 1)
-        def->dflags |= IS_COMPILABLE;
+        def->dflags |= IS_COMPILABLE | flags;
     return (ret);
 }
 
+/**
+ * Compile an interleave of simple items, the automaton has one state
+ * per set of elements already seen among those which are required or
+ * can't repeat.
+ *
+ * @param ctxt  the RelaxNG parser context
+ * @param def  the interleave definition
+ * @returns 0 if success and -1 in case of error
+ */
+static int
+xmlRelaxNGCompileInterleave(xmlRelaxNGParserCtxtPtr ctxt,
+                            xmlRelaxNGDefinePtr def)
+{
+    xmlRelaxNGDefinePtr cur, item;
+    xmlAutomataStatePtr *states, target, oldstate;
+    xmlAutomataPtr oldam;
+    int min, max, bit, required = 0, nbTracked = 0, nbStates, i;
+
+    for (cur = def->content; cur != NULL; cur = cur->next) {
+        item = xmlRelaxNGInterleaveItem(cur, &min, &max);
+        if ((item->type == XML_RELAXNG_ELEMENT) &&
+            ((min == 1) || (max == 1)))
+            nbTracked++;
+    }
+    nbStates = 1 << nbTracked;
+    states = xmlMalloc(nbStates * sizeof(states[0]));
+    if (states == NULL) {
+        xmlRngPErrMemory(ctxt);
+        return (-1);
+    }
+    states[0] = xmlAutomataNewEpsilon(ctxt->am, ctxt->state, NULL);
+    for (i = 1; i < nbStates; i++)
+        states[i] = xmlAutomataNewState(ctxt->am);
+    target = xmlAutomataNewState(ctxt->am);
+
+    bit = 1;
+    for (cur = def->content; cur != NULL; cur = cur->next) {
+        item = xmlRelaxNGInterleaveItem(cur, &min, &max);
+        if (item->type == XML_RELAXNG_TEXT) {
+            for (i = 0; i < nbStates; i++)
+                xmlAutomataNewTransition(ctxt->am, states[i], states[i],
+                                         BAD_CAST "#text", NULL);
+            continue;
+        }
+        if ((min == 0) && (max == -1)) {
+            for (i = 0; i < nbStates; i++)
+                xmlAutomataNewTransition2(ctxt->am, states[i], states[i],
+                                          item->name, item->ns, item);
+        } else {
+            for (i = 0; i < nbStates; i++) {
+                if ((i & bit) == 0)
+                    xmlAutomataNewTransition2(ctxt->am, states[i],
+                                              states[i | bit], item->name,
+                                              item->ns, item);
+                else if (max == -1)
+                    xmlAutomataNewTransition2(ctxt->am, states[i],
+                                              states[i], item->name,
+                                              item->ns, item);
+            }
+            if (min == 1)
+                required |= bit;
+            bit <<= 1;
+        }
+
+        /*
+         * Compile the content of the element on its own
+         */
+        oldam = ctxt->am;
+        oldstate = ctxt->state;
+        ctxt->am = NULL;
+        xmlRelaxNGCompile(ctxt, item);
+        ctxt->am = oldam;
+        ctxt->state = oldstate;
+    }
+    for (i = 0; i < nbStates; i++) {
+        if ((i & required) == required)
+            xmlAutomataNewEpsilon(ctxt->am, states[i], target);
+    }
+    xmlFree(states);
+    ctxt->state = target;
+
+    return (0);
+}
+
 /**
  * Compile the set of definitions, it works recursively, till the
  * element boundaries, where it tries to compile the content if possible
@@ -2899,6 +3543,12 @@ xmlRelaxNGCompile(xmlRelaxNGParserCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
     if ((ctxt == NULL) || (def == NULL))
         return (-1);
 
+    /*
+     * Attributes are validated before the content model
+     */
+    if (def->dflags & IS_ATTRS_ONLY)
+        return (0);
+
     switch (def->type) {
         case XML_RELAXNG_START:
             if ((xmlRelaxNGIsCompilable(def) == 1) && (def->depth != -25)) {
@@ -2930,6 +3580,9 @@ xmlRelaxNGCompile(xmlRelaxNGParserCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
                 xmlAutomataSetFinalState(ctxt->am, ctxt->state);
                 if (xmlAutomataIsDeterminist(ctxt->am))
                     def->contModel = xmlAutomataCompile(ctxt->am);
+                if ((def->contModel != NULL) &&
+                    (xmlRegexpBuildNameTable(def->contModel, NULL) < 0))
+                    xmlRngPErrMemory(ctxt);
 
                 xmlFreeAutomata(ctxt->am);
                 ctxt->state = oldstate;
@@ -2955,9 +3608,19 @@ xmlRelaxNGCompile(xmlRelaxNGParserCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
                     return (-1);
                 xmlAutomataSetFlags(ctxt->am, 1);
                 ctxt->state = xmlAutomataGetInitState(ctxt->am);
-                while (list != NULL) {
-                    xmlRelaxNGCompile(ctxt, list);
-                    list = list->next;
+                if (def->dflags & IS_DATA_CONTENT) {
+                    /*
+                     * Only accept text, its value is checked at the end
+                     * of the element
+                     */
+                    xmlAutomataNewTransition(ctxt->am, ctxt->state,
+                                             ctxt->state, BAD_CAST "#text",
+                                             NULL);
+                } else {
+                    while (list != NULL) {
+                        xmlRelaxNGCompile(ctxt, list);
+                        list = list->next;
+                    }
                 }
                 xmlAutomataSetFinalState(ctxt->am, ctxt->state);
                 def->contModel = xmlAutomataCompile(ctxt->am);
@@ -2967,6 +3630,10 @@ xmlRelaxNGCompile(xmlRelaxNGParserCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
                      */
                     xmlRegFreeRegexp(def->contModel);
                     def->contModel = NULL;
+                } else if (xmlRegexpBuildNameTable(def->contModel,
+                                                   NULL) < 0) {
+                    /* Child names are looked up by hash when validating */
+                    xmlRngPErrMemory(ctxt);
                 }
                 xmlFreeAutomata(ctxt->am);
                 ctxt->state = oldstate;
@@ -3085,9 +3752,11 @@ xmlRelaxNGCompile(xmlRelaxNGParserCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
             ctxt->state =
                 xmlAutomataNewEpsilon(ctxt->am, ctxt->state, NULL);
             break;
+        case XML_RELAXNG_INTERLEAVE:
+            ret = xmlRelaxNGCompileInterleave(ctxt, def);
+            break;
         case XML_RELAXNG_EXCEPT:
         case XML_RELAXNG_ATTRIBUTE:
-        case XML_RELAXNG_INTERLEAVE:
         case XML_RELAXNG_NOT_ALLOWED:
         case XML_RELAXNG_DATATYPE:
         case XML_RELAXNG_LIST:
@@ -3453,7 +4122,7 @@ xmlRelaxNGParseData(xmlRelaxNGParserCtxtPtr ctxt, xmlNodePtr node)
     xmlChar *type;
     xmlChar *library;
     xmlNodePtr content;
-    int tmp;
+    int tmp = 0;
 
     type = xmlGetProp(node, BAD_CAST "type");
     if (type == NULL) {
@@ -3544,12 +4213,12 @@ xmlRelaxNGParseData(xmlRelaxNGParserCtxtPtr ctxt, xmlNodePtr node)
                     lastparam->next = param;
                     lastparam = param;
                 }
-                if (lib != NULL) {
-                }
             }
             content = content->next;
         }
     }
+    if ((lib != NULL) && (lib->compile != NULL) && (tmp == 1))
+        def->compiled = lib->compile(lib->data, def->name, def->attrs);
     /*
      * Handle optional except
      */
@@ -7246,16 +7915,11 @@ xmlRelaxNGCleanupDoc(xmlRelaxNGParserCtxtPtr ctxt, xmlDocPtr doc)
     return (doc);
 }
 
-/**
- * parse a schema definition resource and build an internal
- * XML Schema structure which can be used to validate instances.
- *
- * @param ctxt  a Relax-NG parser context
- * @returns the internal XML RelaxNG structure built from the resource or
- *         NULL in case of error
+/*
+ * Does the actual work of xmlRelaxNGParse.
  */
-xmlRelaxNG *
-xmlRelaxNGParse(xmlRelaxNGParserCtxt *ctxt)
+static xmlRelaxNGPtr
+xmlRelaxNGParseInternal(xmlRelaxNGParserCtxtPtr ctxt)
 {
     xmlRelaxNGPtr ret = NULL;
     xmlDocPtr doc;
@@ -7382,6 +8046,35 @@ xmlRelaxNGParse(xmlRelaxNGParserCtxt *ctxt)
     return (ret);
 }
 
+/**
+ * parse a schema definition resource and build an internal
+ * XML Schema structure which can be used to validate instances.
+ *
+ * @param ctxt  a Relax-NG parser context
+ * @returns the internal XML RelaxNG structure built from the resource or
+ *         NULL in case of error
+ */
+xmlRelaxNG *
+xmlRelaxNGParse(xmlRelaxNGParserCtxt *ctxt)
+{
+    xmlRelaxNGPtr ret;
+    const char *url = NULL;
+    double start;
+
+    if (ctxt != NULL)
+        url = (const char *) ctxt->URL;
+    XML_TRACE_BEGIN(schema_load, 0, url, start);
+
+    ret = xmlRelaxNGParseInternal(ctxt);
+
+    XML_TRACE_END(schema_load, XML_TRACE_SCHEMA_LOAD, url,
+                  ((ctxt != NULL) && (ctxt->buffer != NULL)) ?
+                  (long) ctxt->size : -1,
+                  start);
+
+    return(ret);
+}
+
 /**
  * Set the callback functions used to handle errors for a validation context
  *
@@ -7705,213 +8398,685 @@ xmlRelaxNGDumpTree(FILE * output, xmlRelaxNG *schema)
 
 /************************************************************************
  *									*
- *		Validation of compiled content				*
+ *			Binary serialization				*
  *									*
  ************************************************************************/
-static int xmlRelaxNGValidateDefinition(xmlRelaxNGValidCtxtPtr ctxt,
-                                        xmlRelaxNGDefinePtr define);
 
-/**
- * Handle the callback and if needed validate the element children.
+/*
+ * A compiled grammar is saved as the graph of the definitions
+ * reachable from its start. Definitions get ids in the order they are
+ * first referenced and references are written as ids, 0 for NULL.
+ * The layout is
  *
- * @param exec  the regular expression instance
- * @param token  the token which matched
- * @param transdata  callback data, the define for the subelement if available
- * @param inputdata  callback data, the Relax NG validation context
+ *   magic, format version
+ *   the number of definitions
+ *   whether IDs are checked, the start definition
+ *   the fields of the definitions in the order of their ids
+ *
+ * The fields are read and written by the same functions, so both
+ * directions can't drift apart. Type libraries are saved by their
+ * namespace and looked up again on load.
  */
-static void
-xmlRelaxNGValidateCompiledCallback(xmlRegExecCtxtPtr exec ATTRIBUTE_UNUSED,
-                                   const xmlChar * token,
-                                   void *transdata, void *inputdata)
+
+#define XML_RELAXNG_BIN_MAGIC "LXRB"
+#define XML_RELAXNG_BIN_VERSION 1
+
+typedef struct _xmlRelaxNGBinEntry xmlRelaxNGBinEntry;
+typedef xmlRelaxNGBinEntry *xmlRelaxNGBinEntryPtr;
+struct _xmlRelaxNGBinEntry {
+    const void *ptr;
+    int id;
+};
+
+typedef struct _xmlRelaxNGBinCtxt xmlRelaxNGBinCtxt;
+typedef xmlRelaxNGBinCtxt *xmlRelaxNGBinCtxtPtr;
+struct _xmlRelaxNGBinCtxt {
+    int load;                   /* whether the grammar is read or written */
+    int error;                  /* errors when writing, see reader.error otherwise */
+    xmlRelaxNGDefinePtr *defs;  /* the definitions by id */
+    int nbDefs;
+    int maxDefs;
+    /* Writing */
+    xmlBuf *buf;
+    xmlRelaxNGBinEntryPtr map;  /* the ids of the known definitions */
+    int mapSize;
+    /* Reading */
+    xmlBinReader reader;
+};
+
+static int
+xmlRelaxNGBinMapIndex(xmlRelaxNGBinCtxtPtr ctxt, const void *ptr)
 {
-    xmlRelaxNGValidCtxtPtr ctxt = (xmlRelaxNGValidCtxtPtr) inputdata;
-    xmlRelaxNGDefinePtr define = (xmlRelaxNGDefinePtr) transdata;
-    int ret;
+    size_t v = (size_t) ptr;
+    unsigned int i;
 
-    if (ctxt == NULL) {
-        xmlRngVErr(ctxt, NULL, XML_ERR_INTERNAL_ERROR,
-                   "callback on %s missing context\n", token, NULL);
-        return;
-    }
-    if (define == NULL) {
-        if (token[0] == '#')
-            return;
-        xmlRngVErr(ctxt, NULL, XML_ERR_INTERNAL_ERROR,
-                   "callback on %s missing define\n", token, NULL);
-        if ((ctxt != NULL) && (ctxt->errNo == XML_RELAXNG_OK))
-            ctxt->errNo = XML_RELAXNG_ERR_INTERNAL;
-        return;
-    }
-    if (define->type != XML_RELAXNG_ELEMENT) {
-        xmlRngVErr(ctxt, NULL, XML_ERR_INTERNAL_ERROR,
-                   "callback on %s define is not element\n", token, NULL);
-        if (ctxt->errNo == XML_RELAXNG_OK)
-            ctxt->errNo = XML_RELAXNG_ERR_INTERNAL;
-        return;
-    }
-    ret = xmlRelaxNGValidateDefinition(ctxt, define);
-    if (ret != 0)
-        ctxt->perr = ret;
+    i = (unsigned int) ((v >> 4) ^ (v >> 20)) * 2654435761u;
+    i = (i ^ (i >> 16)) & (ctxt->mapSize - 1);
+    while ((ctxt->map[i].ptr != NULL) && (ctxt->map[i].ptr != ptr))
+        i = (i + 1) & (ctxt->mapSize - 1);
+    return (i);
 }
 
-/**
- * Validate the content model of an element or start using the regexp
- *
- * @param ctxt  the RelaxNG validation context
- * @param regexp  the regular expression as compiled
- * @param content  list of children to test against the regexp
- * @returns 0 in case of success, -1 in case of error.
+/*
+ * Returns the id of a definition, queuing it for writing if it
+ * wasn't seen yet, or -1 in case of error.
  */
 static int
-xmlRelaxNGValidateCompiledContent(xmlRelaxNGValidCtxtPtr ctxt,
-                                  xmlRegexpPtr regexp, xmlNodePtr content)
+xmlRelaxNGBinDefineId(xmlRelaxNGBinCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
 {
-    xmlRegExecCtxtPtr exec;
-    xmlNodePtr cur;
-    int ret = 0;
-    int oldperr;
+    int i;
 
-    if ((ctxt == NULL) || (regexp == NULL))
-        return (-1);
-    oldperr = ctxt->perr;
-    exec = xmlRegNewExecCtxt(regexp,
-                             xmlRelaxNGValidateCompiledCallback, ctxt);
-    ctxt->perr = 0;
-    cur = content;
-    while (cur != NULL) {
-        ctxt->state->seq = cur;
-        switch (cur->type) {
-            case XML_TEXT_NODE:
-            case XML_CDATA_SECTION_NODE:
-                if (xmlIsBlankNode(cur))
-                    break;
-                ret = xmlRegExecPushString(exec, BAD_CAST "#text", ctxt);
-                if (ret < 0) {
-                    VALID_ERR2(XML_RELAXNG_ERR_TEXTWRONG,
-                               cur->parent->name);
-                }
-                break;
-            case XML_ELEMENT_NODE:
-                if (cur->ns != NULL) {
-                    ret = xmlRegExecPushString2(exec, cur->name,
-                                                cur->ns->href, ctxt);
-                } else {
-                    ret = xmlRegExecPushString(exec, cur->name, ctxt);
-                }
-                if (ret < 0) {
-                    VALID_ERR2(XML_RELAXNG_ERR_ELEMWRONG, cur->name);
-                }
-                break;
-            default:
-                break;
+    if (ctxt->nbDefs * 2 >= ctxt->mapSize) {
+        xmlRelaxNGBinEntryPtr old = ctxt->map;
+        int oldSize = ctxt->mapSize;
+        int newSize = (oldSize > 0) ? oldSize * 2 : 256;
+
+        if (oldSize > XML_MAX_ITEMS)
+            return (-1);
+        ctxt->map = xmlMalloc(newSize * sizeof(xmlRelaxNGBinEntry));
+        if (ctxt->map == NULL) {
+            ctxt->map = old;
+            return (-1);
         }
-        if (ret < 0)
-            break;
-        /*
-         * Switch to next element
-         */
-        cur = cur->next;
-    }
-    ret = xmlRegExecPushString(exec, NULL, NULL);
-    if (ret == 1) {
-        ret = 0;
-        ctxt->state->seq = NULL;
-    } else if (ret == 0) {
-        /*
-         * TODO: get some of the names needed to exit the current state of exec
-         */
-        VALID_ERR2(XML_RELAXNG_ERR_NOELEM, BAD_CAST "");
-        ret = -1;
-        if ((ctxt->flags & FLAGS_IGNORABLE) == 0)
-            xmlRelaxNGDumpValidError(ctxt);
-    } else {
-        ret = -1;
+        memset(ctxt->map, 0, newSize * sizeof(xmlRelaxNGBinEntry));
+        ctxt->mapSize = newSize;
+        for (i = 0; i < oldSize; i++) {
+            if (old[i].ptr != NULL)
+                ctxt->map[xmlRelaxNGBinMapIndex(ctxt, old[i].ptr)] = old[i];
+        }
+        xmlFree(old);
     }
-    xmlRegFreeExecCtxt(exec);
-    /*
-     * There might be content model errors outside of the pure
-     * regexp validation, e.g. for attribute values.
-     */
-    if ((ret == 0) && (ctxt->perr != 0)) {
-        ret = ctxt->perr;
+    i = xmlRelaxNGBinMapIndex(ctxt, def);
+    if (ctxt->map[i].ptr != NULL)
+        return (ctxt->map[i].id);
+
+    if (ctxt->nbDefs >= ctxt->maxDefs) {
+        xmlRelaxNGDefinePtr *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(ctxt->maxDefs, sizeof(tmp[0]),
+                                  64, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return (-1);
+        tmp = xmlRealloc(ctxt->defs, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return (-1);
+        ctxt->defs = tmp;
+        ctxt->maxDefs = newSize;
     }
-    ctxt->perr = oldperr;
-    return (ret);
+    ctxt->defs[ctxt->nbDefs++] = def;
+    ctxt->map[i].ptr = def;
+    ctxt->map[i].id = ctxt->nbDefs;
+    return (ctxt->nbDefs);
 }
 
-/************************************************************************
- *									*
- *		Progressive validation of when possible			*
- *									*
- ************************************************************************/
-static int xmlRelaxNGValidateAttributeList(xmlRelaxNGValidCtxtPtr ctxt,
-                                           xmlRelaxNGDefinePtr defines);
-static int xmlRelaxNGValidateElementEnd(xmlRelaxNGValidCtxtPtr ctxt,
-                                        int dolog);
-static void xmlRelaxNGLogBestError(xmlRelaxNGValidCtxtPtr ctxt);
+static int
+xmlRelaxNGBinInt(xmlRelaxNGBinCtxtPtr ctxt, int val)
+{
+    if (ctxt->load)
+        return (xmlBinReadInt(&ctxt->reader));
+    xmlBinWriteInt(ctxt->buf, val);
+    return (val);
+}
 
-/**
- * Push a new regexp for the current node content model on the stack
- *
- * @param ctxt  the validation context
- * @param exec  the regexp runtime for the new content model
- * @returns 0 in case of success and -1 in case of error.
+/*
+ * Every counted item takes at least four bytes, which bounds the
+ * counts of valid input. -1 stands for a missing array.
  */
 static int
-xmlRelaxNGElemPush(xmlRelaxNGValidCtxtPtr ctxt, xmlRegExecCtxtPtr exec)
+xmlRelaxNGBinCount(xmlRelaxNGBinCtxtPtr ctxt, int val)
 {
-    if (ctxt->elemTab == NULL) {
-        ctxt->elemMax = 10;
-        ctxt->elemTab = (xmlRegExecCtxtPtr *) xmlMalloc(ctxt->elemMax *
-                                                        sizeof
-                                                        (xmlRegExecCtxtPtr));
-        if (ctxt->elemTab == NULL) {
-            xmlRngVErrMemory(ctxt);
-            return (-1);
-        }
+    if (!ctxt->load) {
+        xmlBinWriteInt(ctxt->buf, val);
+        return (val);
     }
-    if (ctxt->elemNr >= ctxt->elemMax) {
-        ctxt->elemMax *= 2;
-        ctxt->elemTab = (xmlRegExecCtxtPtr *) xmlRealloc(ctxt->elemTab,
-                                                         ctxt->elemMax *
-                                                         sizeof
-                                                         (xmlRegExecCtxtPtr));
-        if (ctxt->elemTab == NULL) {
-            xmlRngVErrMemory(ctxt);
-            return (-1);
+    val = xmlBinReadInt(&ctxt->reader);
+    if ((val < -1) || (val > (ctxt->reader.end - ctxt->reader.cur) / 4)) {
+        ctxt->reader.error = 1;
+        return (-1);
+    }
+    return (val);
+}
+
+static xmlChar *
+xmlRelaxNGBinStr(xmlRelaxNGBinCtxtPtr ctxt, xmlChar *str)
+{
+    if (ctxt->load)
+        return (xmlBinReadStrdup(&ctxt->reader));
+    xmlBinWriteString(ctxt->buf, str);
+    return (str);
+}
+
+static xmlRelaxNGDefinePtr
+xmlRelaxNGBinRef(xmlRelaxNGBinCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
+{
+    int id = 0;
+
+    if (ctxt->load) {
+        id = xmlBinReadInt(&ctxt->reader);
+        if ((id > 0) && (id <= ctxt->nbDefs))
+            return (ctxt->defs[id - 1]);
+        if (id != 0)
+            ctxt->reader.error = 1;
+        return (NULL);
+    }
+    if (def != NULL) {
+        id = xmlRelaxNGBinDefineId(ctxt, def);
+        if (id < 0) {
+            ctxt->error = 1;
+            id = 0;
         }
     }
-    ctxt->elemTab[ctxt->elemNr++] = exec;
-    ctxt->elem = exec;
+    xmlBinWriteInt(ctxt->buf, id);
+    return (def);
+}
+
+static void
+xmlRelaxNGBinSaveData(void *ctxt, xmlBuf *buf ATTRIBUTE_UNUSED, void *data)
+{
+    xmlRelaxNGBinRef((xmlRelaxNGBinCtxtPtr) ctxt, data);
+}
+
+static void *
+xmlRelaxNGBinLoadData(void *ctxt, xmlBinReader *reader ATTRIBUTE_UNUSED)
+{
+    return (xmlRelaxNGBinRef((xmlRelaxNGBinCtxtPtr) ctxt, NULL));
+}
+
+static xmlRegexpPtr
+xmlRelaxNGBinRegexp(xmlRelaxNGBinCtxtPtr ctxt, xmlRegexpPtr regexp)
+{
+    if (!xmlRelaxNGBinInt(ctxt, regexp != NULL))
+        return (NULL);
+    if (ctxt->load)
+        return (xmlRegexpLoad(&ctxt->reader, xmlRelaxNGBinLoadData, ctxt));
+    xmlRegexpSave(regexp, ctxt->buf, xmlRelaxNGBinSaveData, ctxt);
+    return (regexp);
+}
+
+static xmlRelaxNGTypeLibraryPtr
+xmlRelaxNGBinLib(xmlRelaxNGBinCtxtPtr ctxt, xmlRelaxNGTypeLibraryPtr lib)
+{
+    xmlChar *ns;
+
+    if (!ctxt->load) {
+        xmlBinWriteString(ctxt->buf, (lib != NULL) ? lib->namespace : NULL);
+        return (lib);
+    }
+    ns = xmlBinReadStrdup(&ctxt->reader);
+    if (ns == NULL)
+        return (NULL);
+    lib = xmlHashLookup(xmlRelaxNGRegisteredTypes, ns);
+    if (lib == NULL)
+        ctxt->reader.error = 1;
+    xmlFree(ns);
+    return (lib);
+}
+
+/*
+ * Arrays of definitions, terminated by NULL, as used by interleaves.
+ */
+static xmlRelaxNGDefinePtr *
+xmlRelaxNGBinDefArray(xmlRelaxNGBinCtxtPtr ctxt, xmlRelaxNGDefinePtr *list)
+{
+    int n = 0, i;
+
+    if (!ctxt->load) {
+        if (list == NULL)
+            n = -1;
+        else
+            while (list[n] != NULL)
+                n++;
+    }
+    n = xmlRelaxNGBinCount(ctxt, n);
+    if (n < 0)
+        return (NULL);
+    if (ctxt->load) {
+        list = xmlMalloc((n + 1) * sizeof(list[0]));
+        if (list == NULL) {
+            xmlRngVErrMemory(NULL);
+            ctxt->reader.error = 1;
+            return (NULL);
+        }
+        list[n] = NULL;
+    }
+    for (i = 0; i < n; i++) {
+        if (!ctxt->load) {
+            xmlRelaxNGBinRef(ctxt, list[i]);
+        } else {
+            list[i] = xmlRelaxNGBinRef(ctxt, NULL);
+            if (list[i] == NULL)
+                ctxt->reader.error = 1;
+        }
+    }
+    return (list);
+}
+
+typedef struct {
+    xmlRelaxNGBinCtxtPtr ctxt;
+    int values;                 /* the payloads are integers */
+} xmlRelaxNGBinTriageCtxt;
+
+static void
+xmlRelaxNGBinSaveTriageEntry(void *payload, void *data,
+                             const xmlChar *name, const xmlChar *name2,
+                             const xmlChar *name3 ATTRIBUTE_UNUSED)
+{
+    xmlRelaxNGBinTriageCtxt *tctxt = data;
+
+    xmlBinWriteString(tctxt->ctxt->buf, name);
+    xmlBinWriteString(tctxt->ctxt->buf, name2);
+    if (tctxt->values)
+        xmlBinWriteInt(tctxt->ctxt->buf, XML_PTR_TO_INT(payload));
+    else
+        xmlRelaxNGBinRef(tctxt->ctxt, payload);
+}
+
+/*
+ * The hash tables directing elements to the branches of choices or
+ * to the groups of interleaves. `nbValues` is the number of groups,
+ * 0 if the payloads are definitions.
+ */
+static xmlHashTablePtr
+xmlRelaxNGBinTriage(xmlRelaxNGBinCtxtPtr ctxt, xmlHashTablePtr triage,
+                    int nbValues)
+{
+    xmlRelaxNGBinTriageCtxt tctxt;
+    int n, i;
+
+    n = xmlRelaxNGBinCount(ctxt, (triage != NULL) ? xmlHashSize(triage) : -1);
+    if (n < 0)
+        return (NULL);
+    if (!ctxt->load) {
+        tctxt.ctxt = ctxt;
+        tctxt.values = (nbValues > 0);
+        xmlHashScanFull(triage, xmlRelaxNGBinSaveTriageEntry, &tctxt);
+        return (triage);
+    }
+
+    triage = xmlHashCreate(n);
+    if (triage == NULL) {
+        xmlRngVErrMemory(NULL);
+        ctxt->reader.error = 1;
+        return (NULL);
+    }
+    for (i = 0; (i < n) && (!ctxt->reader.error); i++) {
+        xmlChar *name, *name2;
+        void *payload;
+
+        name = xmlBinReadStrdup(&ctxt->reader);
+        name2 = xmlBinReadStrdup(&ctxt->reader);
+        if (nbValues > 0) {
+            int val = xmlBinReadInt(&ctxt->reader);
+
+            if ((val < 1) || (val > nbValues))
+                ctxt->reader.error = 1;
+            payload = XML_INT_TO_PTR(val);
+        } else {
+            payload = xmlRelaxNGBinRef(ctxt, NULL);
+            if (payload == NULL)
+                ctxt->reader.error = 1;
+        }
+        if ((name == NULL) ||
+            ((!ctxt->reader.error) &&
+             (xmlHashAddEntry2(triage, name, name2, payload) != 0)))
+            ctxt->reader.error = 1;
+        xmlFree(name);
+        xmlFree(name2);
+    }
+    return (triage);
+}
+
+static xmlRelaxNGPartitionPtr
+xmlRelaxNGBinPartition(xmlRelaxNGBinCtxtPtr ctxt,
+                       xmlRelaxNGPartitionPtr partitions)
+{
+    xmlRelaxNGInterleaveGroupPtr group;
+    int i, n;
+
+    if (!xmlRelaxNGBinInt(ctxt, partitions != NULL))
+        return (NULL);
+    if (ctxt->load) {
+        partitions = xmlMalloc(sizeof(xmlRelaxNGPartition));
+        if (partitions == NULL) {
+            xmlRngVErrMemory(NULL);
+            ctxt->reader.error = 1;
+            return (NULL);
+        }
+        memset(partitions, 0, sizeof(xmlRelaxNGPartition));
+    }
+    partitions->flags = xmlRelaxNGBinInt(ctxt, partitions->flags);
+    n = xmlRelaxNGBinCount(ctxt, partitions->nbgroups);
+    if (n <= 0) {
+        ctxt->reader.error = 1;
+        return (partitions);
+    }
+    if (ctxt->load) {
+        partitions->groups = xmlMalloc(n * sizeof(group));
+        if (partitions->groups == NULL) {
+            xmlRngVErrMemory(NULL);
+            ctxt->reader.error = 1;
+            return (partitions);
+        }
+        memset(partitions->groups, 0, n * sizeof(group));
+        partitions->nbgroups = n;
+    }
+    for (i = 0; (i < n) && (!ctxt->reader.error); i++) {
+        group = partitions->groups[i];
+        if (ctxt->load) {
+            group = xmlMalloc(sizeof(xmlRelaxNGInterleaveGroup));
+            if (group == NULL) {
+                xmlRngVErrMemory(NULL);
+                ctxt->reader.error = 1;
+                break;
+            }
+            memset(group, 0, sizeof(xmlRelaxNGInterleaveGroup));
+            partitions->groups[i] = group;
+        }
+        group->rule = xmlRelaxNGBinRef(ctxt, group->rule);
+        group->defs = xmlRelaxNGBinDefArray(ctxt, group->defs);
+        group->attrs = xmlRelaxNGBinDefArray(ctxt, group->attrs);
+    }
+    partitions->triage = xmlRelaxNGBinTriage(ctxt, partitions->triage, n);
+    return (partitions);
+}
+
+static void
+xmlRelaxNGBinDefine(xmlRelaxNGBinCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
+{
+    xmlRelaxNGTypeLibraryPtr lib;
+    int type;
+
+    type = xmlRelaxNGBinInt(ctxt, def->type);
+    if ((type < XML_RELAXNG_NOOP) || (type > XML_RELAXNG_START)) {
+        ctxt->reader.error = 1;
+        return;
+    }
+    def->type = type;
+    def->name = xmlRelaxNGBinStr(ctxt, def->name);
+    def->ns = xmlRelaxNGBinStr(ctxt, def->ns);
+    def->value = xmlRelaxNGBinStr(ctxt, def->value);
+    def->content = xmlRelaxNGBinRef(ctxt, def->content);
+    def->parent = xmlRelaxNGBinRef(ctxt, def->parent);
+    def->next = xmlRelaxNGBinRef(ctxt, def->next);
+    def->nameClass = xmlRelaxNGBinRef(ctxt, def->nameClass);
+    def->nextHash = xmlRelaxNGBinRef(ctxt, def->nextHash);
+    def->depth = xmlRelaxNGBinInt(ctxt, def->depth);
+    def->dflags = xmlRelaxNGBinInt(ctxt, def->dflags);
+
+    switch (def->type) {
+        case XML_RELAXNG_DATATYPE:
+            def->data = xmlRelaxNGBinLib(ctxt, def->data);
+            def->attrs = xmlRelaxNGBinRef(ctxt, def->attrs);
+            break;
+        case XML_RELAXNG_VALUE:
+            /*
+             * The precomputed value of the XML Schema datatypes
+             */
+            lib = xmlRelaxNGBinLib(ctxt, def->data);
+            def->data = lib;
+            if ((lib != NULL) && (lib->freef == xmlRelaxNGSchemaFreeValue)) {
+                if (ctxt->load)
+                    def->attrs = (void *) xmlSchemaValLoad(&ctxt->reader);
+                else
+                    xmlSchemaValSave((void *) def->attrs, ctxt->buf);
+            }
+            break;
+        case XML_RELAXNG_CHOICE:
+            def->attrs = xmlRelaxNGBinRef(ctxt, def->attrs);
+            def->data = xmlRelaxNGBinTriage(ctxt, def->data, 0);
+            break;
+        case XML_RELAXNG_INTERLEAVE:
+            def->attrs = xmlRelaxNGBinRef(ctxt, def->attrs);
+            def->data = xmlRelaxNGBinPartition(ctxt, def->data);
+            break;
+        default:
+            def->attrs = xmlRelaxNGBinRef(ctxt, def->attrs);
+            break;
+    }
+    def->contModel = xmlRelaxNGBinRegexp(ctxt, def->contModel);
+}
+
+/**
+ * Serialize a compiled Relax-NG grammar, including the automata of
+ * its content models, to a binary form which can be loaded with
+ * #xmlRelaxNGLoadMemory much faster than parsing the schema documents.
+ *
+ * The format is only readable by the same version of the library.
+ *
+ * @since 2.16.0
+ * @param schema  a compiled grammar
+ * @param mem  pointer to the resulting buffer, to be freed with xmlFree
+ * @param size  pointer to the size of the buffer
+ * @returns 0 on success, -1 in case of error.
+ */
+int
+xmlRelaxNGSaveMemory(xmlRelaxNG *schema, xmlChar **mem, int *size)
+{
+    xmlRelaxNGBinCtxt ctxt;
+    xmlBufPtr out = NULL;
+    size_t len;
+    int i, ret = -1;
+
+    if (mem != NULL)
+        *mem = NULL;
+    if (size != NULL)
+        *size = 0;
+    if ((schema == NULL) || (schema->topgrammar == NULL) ||
+        (mem == NULL) || (size == NULL))
+        return (-1);
+
+    memset(&ctxt, 0, sizeof(ctxt));
+    ctxt.buf = xmlBufCreate(4096);
+    out = xmlBufCreate(4096);
+    if ((ctxt.buf == NULL) || (out == NULL)) {
+        xmlRngVErrMemory(NULL);
+        goto done;
+    }
+
+    /*
+     * Write the body first, it collects the definitions.
+     */
+    xmlRelaxNGBinInt(&ctxt, schema->idref);
+    xmlRelaxNGBinRef(&ctxt, schema->topgrammar->start);
+    for (i = 0; (i < ctxt.nbDefs) && (!ctxt.error); i++)
+        xmlRelaxNGBinDefine(&ctxt, ctxt.defs[i]);
+    if (ctxt.error) {
+        xmlRngVErrMemory(NULL);
+        goto done;
+    }
+
+    xmlBufAdd(out, BAD_CAST XML_RELAXNG_BIN_MAGIC, 4);
+    xmlBinWriteInt(out, XML_RELAXNG_BIN_VERSION);
+    xmlBinWriteInt(out, ctxt.nbDefs);
+    xmlBufAdd(out, xmlBufContent(ctxt.buf), xmlBufUse(ctxt.buf));
+
+    len = xmlBufUse(out);
+    if (len > INT_MAX)
+        goto done;
+    *mem = xmlBufDetach(out);
+    if (*mem == NULL) {
+        xmlRngVErrMemory(NULL);
+        goto done;
+    }
+    *size = len;
+    ret = 0;
+
+done:
+    xmlBufFree(out);
+    xmlBufFree(ctxt.buf);
+    xmlFree(ctxt.map);
+    xmlFree(ctxt.defs);
+    return (ret);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+/**
+ * Serialize a compiled Relax-NG grammar to a file, see
+ * #xmlRelaxNGSaveMemory.
+ *
+ * @since 2.16.0
+ * @param schema  a compiled grammar
+ * @param filename  the file name or URI
+ * @returns 0 on success, -1 in case of error.
+ */
+int
+xmlRelaxNGSave(xmlRelaxNG *schema, const char *filename)
+{
+    xmlOutputBufferPtr out;
+    xmlChar *mem;
+    int size;
+
+    if (filename == NULL)
+        return (-1);
+    if (xmlRelaxNGSaveMemory(schema, &mem, &size) < 0)
+        return (-1);
+    out = xmlOutputBufferCreateFilename(filename, NULL, 0);
+    if (out == NULL) {
+        xmlFree(mem);
+        return (-1);
+    }
+    xmlOutputBufferWrite(out, size, (const char *) mem);
+    xmlFree(mem);
+    if (xmlOutputBufferClose(out) < 0)
+        return (-1);
     return (0);
 }
+#endif /* LIBXML_OUTPUT_ENABLED */
 
 /**
- * Pop the regexp of the current node content model from the stack
+ * Load a compiled Relax-NG grammar serialized by
+ * #xmlRelaxNGSaveMemory. The buffer can be freed or unmapped once
+ * the function returns.
  *
- * @param ctxt  the validation context
- * @returns the exec or NULL if empty
+ * The input must have been written by the same version of the
+ * library. It's checked for truncation and bad references but not
+ * meant to be untrusted.
+ *
+ * @since 2.16.0
+ * @param mem  the serialized grammar
+ * @param size  the size of the buffer
+ * @returns the compiled grammar or NULL in case of error.
  */
-static xmlRegExecCtxtPtr
-xmlRelaxNGElemPop(xmlRelaxNGValidCtxtPtr ctxt)
+xmlRelaxNG *
+xmlRelaxNGLoadMemory(const char *mem, int size)
 {
-    xmlRegExecCtxtPtr ret;
+    xmlRelaxNGBinCtxt ctxt;
+    xmlRelaxNGPtr schema = NULL;
+    xmlRelaxNGDefinePtr def;
+    int i, n;
 
-    if (ctxt->elemNr <= 0)
+    if ((mem == NULL) || (size < 12) ||
+        (memcmp(mem, XML_RELAXNG_BIN_MAGIC, 4) != 0))
         return (NULL);
-    ctxt->elemNr--;
-    ret = ctxt->elemTab[ctxt->elemNr];
-    ctxt->elemTab[ctxt->elemNr] = NULL;
-    if (ctxt->elemNr > 0)
-        ctxt->elem = ctxt->elemTab[ctxt->elemNr - 1];
-    else
-        ctxt->elem = NULL;
+
+    memset(&ctxt, 0, sizeof(ctxt));
+    ctxt.load = 1;
+    ctxt.reader.cur = (const unsigned char *) mem + 4;
+    ctxt.reader.end = (const unsigned char *) mem + size;
+    if (xmlBinReadInt(&ctxt.reader) != XML_RELAXNG_BIN_VERSION)
+        return (NULL);
+    n = xmlRelaxNGBinCount(&ctxt, 0);
+    if (n <= 0)
+        return (NULL);
+
+    if (xmlRelaxNGInitTypes() < 0)
+        return (NULL);
+    schema = xmlRelaxNGNewRelaxNG(NULL);
+    if (schema == NULL)
+        return (NULL);
+    schema->topgrammar = xmlRelaxNGNewGrammar(NULL);
+    schema->defTab = xmlMalloc(n * sizeof(xmlRelaxNGDefinePtr));
+    if ((schema->topgrammar == NULL) || (schema->defTab == NULL)) {
+        xmlRngVErrMemory(NULL);
+        goto error;
+    }
+
+    /*
+     * Allocate all definitions first, so that references can be
+     * resolved while reading. The grammar owns them.
+     */
+    for (i = 0; i < n; i++) {
+        def = xmlMalloc(sizeof(xmlRelaxNGDefine));
+        if (def == NULL) {
+            xmlRngVErrMemory(NULL);
+            goto error;
+        }
+        memset(def, 0, sizeof(xmlRelaxNGDefine));
+        schema->defTab[schema->defNr++] = def;
+    }
+    ctxt.defs = schema->defTab;
+    ctxt.nbDefs = n;
+
+    schema->idref = xmlRelaxNGBinInt(&ctxt, 0);
+    schema->topgrammar->start = xmlRelaxNGBinRef(&ctxt, NULL);
+    for (i = 0; (i < n) && (!ctxt.reader.error); i++)
+        xmlRelaxNGBinDefine(&ctxt, schema->defTab[i]);
+    if ((ctxt.reader.error) || (schema->topgrammar->start == NULL) ||
+        (ctxt.reader.cur != ctxt.reader.end))
+        goto error;
+
+    /*
+     * Compiled datatypes aren't serialized, rebuild them once all
+     * the params are loaded.
+     */
+    for (i = 0; i < n; i++) {
+        xmlRelaxNGTypeLibraryPtr lib;
+
+        def = schema->defTab[i];
+        if (def->type != XML_RELAXNG_DATATYPE)
+            continue;
+        lib = (xmlRelaxNGTypeLibraryPtr) def->data;
+        if ((lib != NULL) && (lib->compile != NULL))
+            def->compiled = lib->compile(lib->data, def->name, def->attrs);
+    }
+
+    return (schema);
+
+error:
+    xmlRelaxNGFree(schema);
+    return (NULL);
+}
+
+/**
+ * Load a compiled Relax-NG grammar from a file written by
+ * #xmlRelaxNGSave.
+ *
+ * @since 2.16.0
+ * @param filename  the file name or URI
+ * @returns the compiled grammar or NULL in case of error.
+ */
+xmlRelaxNG *
+xmlRelaxNGLoad(const char *filename)
+{
+    xmlParserInputBufferPtr in;
+    xmlRelaxNGPtr ret = NULL;
+    int res;
+
+    if ((filename == NULL) ||
+        (xmlParserInputBufferCreateUrl(filename, XML_CHAR_ENCODING_NONE, 0,
+                                       &in) != XML_ERR_OK))
+        return (NULL);
+    do {
+        res = xmlParserInputBufferGrow(in, 65536);
+    } while (res > 0);
+    if ((res == 0) && (xmlBufUse(in->buffer) <= INT_MAX))
+        ret = xmlRelaxNGLoadMemory((const char *) xmlBufContent(in->buffer),
+                                   xmlBufUse(in->buffer));
+    xmlFreeParserInputBuffer(in);
     return (ret);
 }
 
+/************************************************************************
+ *									*
+ *		Validation of compiled content				*
+ *									*
+ ************************************************************************/
+static int xmlRelaxNGValidateDefinition(xmlRelaxNGValidCtxtPtr ctxt,
+                                        xmlRelaxNGDefinePtr define);
+
 /**
  * Handle the callback and if needed validate the element children.
- * some of the in/out information are passed via the context in `inputdata`.
  *
  * @param exec  the regular expression instance
  * @param token  the token which matched
@@ -7919,24 +9084,19 @@ xmlRelaxNGElemPop(xmlRelaxNGValidCtxtPtr ctxt)
  * @param inputdata  callback data, the Relax NG validation context
  */
 static void
-xmlRelaxNGValidateProgressiveCallback(xmlRegExecCtxtPtr exec
-                                      ATTRIBUTE_UNUSED,
-                                      const xmlChar * token,
-                                      void *transdata, void *inputdata)
+xmlRelaxNGValidateCompiledCallback(xmlRegExecCtxtPtr exec ATTRIBUTE_UNUSED,
+                                   const xmlChar * token,
+                                   void *transdata, void *inputdata)
 {
     xmlRelaxNGValidCtxtPtr ctxt = (xmlRelaxNGValidCtxtPtr) inputdata;
     xmlRelaxNGDefinePtr define = (xmlRelaxNGDefinePtr) transdata;
-    xmlRelaxNGValidStatePtr state, oldstate;
-    xmlNodePtr node;
-    int ret = 0, oldflags;
+    int ret;
 
     if (ctxt == NULL) {
         xmlRngVErr(ctxt, NULL, XML_ERR_INTERNAL_ERROR,
                    "callback on %s missing context\n", token, NULL);
         return;
     }
-    node = ctxt->pnode;
-    ctxt->pstate = 1;
     if (define == NULL) {
         if (token[0] == '#')
             return;
@@ -7944,7 +9104,6 @@ xmlRelaxNGValidateProgressiveCallback(xmlRegExecCtxtPtr exec
                    "callback on %s missing define\n", token, NULL);
         if ((ctxt != NULL) && (ctxt->errNo == XML_RELAXNG_OK))
             ctxt->errNo = XML_RELAXNG_ERR_INTERNAL;
-        ctxt->pstate = -1;
         return;
     }
     if (define->type != XML_RELAXNG_ELEMENT) {
@@ -7952,31 +9111,278 @@ xmlRelaxNGValidateProgressiveCallback(xmlRegExecCtxtPtr exec
                    "callback on %s define is not element\n", token, NULL);
         if (ctxt->errNo == XML_RELAXNG_OK)
             ctxt->errNo = XML_RELAXNG_ERR_INTERNAL;
-        ctxt->pstate = -1;
-        return;
-    }
-    if (node->type != XML_ELEMENT_NODE) {
-        VALID_ERR(XML_RELAXNG_ERR_NOTELEM);
-        if ((ctxt->flags & FLAGS_IGNORABLE) == 0)
-            xmlRelaxNGDumpValidError(ctxt);
-        ctxt->pstate = -1;
         return;
     }
-    if (define->contModel == NULL) {
-        /*
-         * this node cannot be validated in a streamable fashion
+    ret = xmlRelaxNGValidateDefinition(ctxt, define);
+    if (ret != 0)
+        ctxt->perr = ret;
+}
+
+/**
+ * Find an element which the content model still expects when the
+ * end of the content was reached too early.
+ *
+ * @param exec  the regular expression instance
+ * @param buf  buffer for the element name
+ * @param size  size of the buffer
+ * @returns the local name of the first expected element or an empty
+ * string if none is known.
+ */
+static const xmlChar *
+xmlRelaxNGExpectedElement(xmlRegExecCtxtPtr exec, xmlChar *buf, int size)
+{
+    xmlChar *values[MAX_ERROR];
+    int nbval = MAX_ERROR, nbneg = 0, terminal = 0;
+    int i, len;
+
+    buf[0] = 0;
+    if (xmlRegExecNextValues(exec, &nbval, &nbneg, values, &terminal) < 0)
+        return(buf);
+
+    for (i = 0; i < nbval; i++) {
+        const xmlChar *sep;
+
+        /* skip text and other special tokens */
+        if ((values[i] == NULL) || (values[i][0] == '#'))
+            continue;
+
+        /* namespaced names are stored as "name|ns" */
+        sep = xmlStrchr(values[i], '|');
+        len = (sep != NULL) ? sep - values[i] : xmlStrlen(values[i]);
+        if (len >= size)
+            len = size - 1;
+        memcpy(buf, values[i], len);
+        buf[len] = 0;
+        break;
+    }
+
+    return(buf);
+}
+
+/**
+ * Validate the content model of an element or start using the regexp
+ *
+ * @param ctxt  the RelaxNG validation context
+ * @param regexp  the regular expression as compiled
+ * @param content  list of children to test against the regexp
+ * @returns 0 in case of success, -1 in case of error.
+ */
+static int
+xmlRelaxNGValidateCompiledContent(xmlRelaxNGValidCtxtPtr ctxt,
+                                  xmlRegexpPtr regexp, xmlNodePtr content)
+{
+    xmlRegExecCtxtPtr exec;
+    xmlNodePtr cur;
+    int ret = 0;
+    int oldperr;
+
+    if ((ctxt == NULL) || (regexp == NULL))
+        return (-1);
+    oldperr = ctxt->perr;
+    exec = xmlRegExecPoolGet(ctxt->execPool, regexp,
+                             xmlRelaxNGValidateCompiledCallback, ctxt);
+    ctxt->perr = 0;
+    cur = content;
+    while (cur != NULL) {
+        ctxt->state->seq = cur;
+        switch (cur->type) {
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+                if (xmlIsBlankNode(cur))
+                    break;
+                ret = xmlRegExecPushString(exec, BAD_CAST "#text", ctxt);
+                if (ret < 0) {
+                    VALID_ERR2(XML_RELAXNG_ERR_TEXTWRONG,
+                               cur->parent->name);
+                }
+                break;
+            case XML_ELEMENT_NODE:
+                ret = xmlRegExecPushName(exec, cur->name,
+                                         cur->ns ? cur->ns->href : NULL, 0,
+                                         ctxt);
+                if (ret < 0) {
+                    VALID_ERR2(XML_RELAXNG_ERR_ELEMWRONG, cur->name);
+                }
+                break;
+            default:
+                break;
+        }
+        if (ret < 0)
+            break;
+        /*
+         * Switch to next element
+         */
+        cur = cur->next;
+    }
+    ret = xmlRegExecPushString(exec, NULL, NULL);
+    if (ret == 1) {
+        ret = 0;
+        ctxt->state->seq = NULL;
+    } else if (ret == 0) {
+        xmlChar name[100];
+
+        VALID_ERR2P(XML_RELAXNG_ERR_NOELEM,
+                    xmlRelaxNGExpectedElement(exec, name, sizeof(name)));
+        ret = -1;
+        if ((ctxt->flags & FLAGS_IGNORABLE) == 0)
+            xmlRelaxNGDumpValidError(ctxt);
+    } else {
+        ret = -1;
+    }
+    xmlRegExecPoolPut(ctxt->execPool, exec);
+    /*
+     * There might be content model errors outside of the pure
+     * regexp validation, e.g. for attribute values.
+     */
+    if ((ret == 0) && (ctxt->perr != 0)) {
+        ret = ctxt->perr;
+    }
+    ctxt->perr = oldperr;
+    return (ret);
+}
+
+/************************************************************************
+ *									*
+ *		Progressive validation of when possible			*
+ *									*
+ ************************************************************************/
+static int xmlRelaxNGValidateElementAttributes(xmlRelaxNGValidCtxtPtr ctxt,
+                                               xmlRelaxNGDefinePtr define);
+static int xmlRelaxNGValidateElementEnd(xmlRelaxNGValidCtxtPtr ctxt,
+                                        int dolog);
+static int xmlRelaxNGValidateDefinitionList(xmlRelaxNGValidCtxtPtr ctxt,
+                                            xmlRelaxNGDefinePtr define);
+static void xmlRelaxNGLogBestError(xmlRelaxNGValidCtxtPtr ctxt);
+
+/**
+ * Push a new regexp for the current node content model on the stack
+ *
+ * @param ctxt  the validation context
+ * @param exec  the regexp runtime for the new content model
+ * @returns 0 in case of success and -1 in case of error.
+ */
+static int
+xmlRelaxNGElemPush(xmlRelaxNGValidCtxtPtr ctxt, xmlRegExecCtxtPtr exec)
+{
+    if (ctxt->elemTab == NULL) {
+        ctxt->elemMax = 10;
+        ctxt->elemTab = (xmlRegExecCtxtPtr *) xmlMalloc(ctxt->elemMax *
+                                                        sizeof
+                                                        (xmlRegExecCtxtPtr));
+        if (ctxt->elemTab == NULL) {
+            xmlRngVErrMemory(ctxt);
+            return (-1);
+        }
+    }
+    if (ctxt->elemNr >= ctxt->elemMax) {
+        ctxt->elemMax *= 2;
+        ctxt->elemTab = (xmlRegExecCtxtPtr *) xmlRealloc(ctxt->elemTab,
+                                                         ctxt->elemMax *
+                                                         sizeof
+                                                         (xmlRegExecCtxtPtr));
+        if (ctxt->elemTab == NULL) {
+            xmlRngVErrMemory(ctxt);
+            return (-1);
+        }
+    }
+    ctxt->elemTab[ctxt->elemNr++] = exec;
+    ctxt->elem = exec;
+    return (0);
+}
+
+/**
+ * Pop the regexp of the current node content model from the stack
+ *
+ * @param ctxt  the validation context
+ * @returns the exec or NULL if empty
+ */
+static xmlRegExecCtxtPtr
+xmlRelaxNGElemPop(xmlRelaxNGValidCtxtPtr ctxt)
+{
+    xmlRegExecCtxtPtr ret;
+
+    if (ctxt->elemNr <= 0)
+        return (NULL);
+    ctxt->elemNr--;
+    ret = ctxt->elemTab[ctxt->elemNr];
+    ctxt->elemTab[ctxt->elemNr] = NULL;
+    if (ctxt->elemNr > 0)
+        ctxt->elem = ctxt->elemTab[ctxt->elemNr - 1];
+    else
+        ctxt->elem = NULL;
+    return (ret);
+}
+
+/**
+ * Handle the callback and if needed validate the element children.
+ * some of the in/out information are passed via the context in `inputdata`.
+ *
+ * @param exec  the regular expression instance
+ * @param token  the token which matched
+ * @param transdata  callback data, the define for the subelement if available
+ * @param inputdata  callback data, the Relax NG validation context
+ */
+static void
+xmlRelaxNGValidateProgressiveCallback(xmlRegExecCtxtPtr exec
+                                      ATTRIBUTE_UNUSED,
+                                      const xmlChar * token,
+                                      void *transdata, void *inputdata)
+{
+    xmlRelaxNGValidCtxtPtr ctxt = (xmlRelaxNGValidCtxtPtr) inputdata;
+    xmlRelaxNGDefinePtr define = (xmlRelaxNGDefinePtr) transdata;
+    xmlRelaxNGValidStatePtr state, oldstate;
+    xmlNodePtr node;
+    int ret = 0, oldflags;
+
+    if (ctxt == NULL) {
+        xmlRngVErr(ctxt, NULL, XML_ERR_INTERNAL_ERROR,
+                   "callback on %s missing context\n", token, NULL);
+        return;
+    }
+    node = ctxt->pnode;
+    ctxt->pstate = 1;
+    if (define == NULL) {
+        if (token[0] == '#')
+            return;
+        xmlRngVErr(ctxt, NULL, XML_ERR_INTERNAL_ERROR,
+                   "callback on %s missing define\n", token, NULL);
+        if ((ctxt != NULL) && (ctxt->errNo == XML_RELAXNG_OK))
+            ctxt->errNo = XML_RELAXNG_ERR_INTERNAL;
+        ctxt->pstate = -1;
+        return;
+    }
+    if (define->type != XML_RELAXNG_ELEMENT) {
+        xmlRngVErr(ctxt, NULL, XML_ERR_INTERNAL_ERROR,
+                   "callback on %s define is not element\n", token, NULL);
+        if (ctxt->errNo == XML_RELAXNG_OK)
+            ctxt->errNo = XML_RELAXNG_ERR_INTERNAL;
+        ctxt->pstate = -1;
+        return;
+    }
+    if (node->type != XML_ELEMENT_NODE) {
+        VALID_ERR(XML_RELAXNG_ERR_NOTELEM);
+        if ((ctxt->flags & FLAGS_IGNORABLE) == 0)
+            xmlRelaxNGDumpValidError(ctxt);
+        ctxt->pstate = -1;
+        return;
+    }
+    if (define->contModel == NULL) {
+        /*
+         * this node cannot be validated in a streamable fashion
          */
         ctxt->pstate = 0;
         ctxt->pdef = define;
         return;
     }
-    exec = xmlRegNewExecCtxt(define->contModel,
+    exec = xmlRegExecPoolGet(ctxt->execPool, define->contModel,
                              xmlRelaxNGValidateProgressiveCallback, ctxt);
     if (exec == NULL) {
         ctxt->pstate = -1;
         return;
     }
     xmlRelaxNGElemPush(ctxt, exec);
+    if (define->dflags & IS_DATA_CONTENT)
+        ctxt->pdata = define;
 
     /*
      * Validate the attributes part of the content.
@@ -7988,8 +9394,8 @@ xmlRelaxNGValidateProgressiveCallback(xmlRegExecCtxtPtr exec
     }
     oldstate = ctxt->state;
     ctxt->state = state;
-    if (define->attrs != NULL) {
-        ret = xmlRelaxNGValidateAttributeList(ctxt, define->attrs);
+    if ((define->attrs != NULL) || (define->dflags & HAS_CONTENT_ATTRS)) {
+        ret = xmlRelaxNGValidateElementAttributes(ctxt, define);
         if (ret != 0) {
             ctxt->pstate = -1;
             VALID_ERR2(XML_RELAXNG_ERR_ATTRVALID, node->name);
@@ -7997,9 +9403,10 @@ xmlRelaxNGValidateProgressiveCallback(xmlRegExecCtxtPtr exec
     }
     if (ctxt->state != NULL) {
         ctxt->state->seq = NULL;
-        ret = xmlRelaxNGValidateElementEnd(ctxt, 1);
-        if (ret != 0) {
-            ctxt->pstate = -1;
+        if (ret == 0) {
+            ret = xmlRelaxNGValidateElementEnd(ctxt, 1);
+            if (ret != 0)
+                ctxt->pstate = -1;
         }
         xmlRelaxNGFreeValidState(ctxt, ctxt->state);
     } else if (ctxt->states != NULL) {
@@ -8062,6 +9469,15 @@ xmlRelaxNGValidatePushElement(xmlRelaxNGValidCtxt *ctxt,
     if ((ctxt == NULL) || (elem == NULL))
         return (-1);
 
+    /*
+     * Elements with data content have no children
+     */
+    if (ctxt->pdata != NULL) {
+        ctxt->pdata = NULL;
+        xmlFree(ctxt->pvalue);
+        ctxt->pvalue = NULL;
+    }
+
     if (ctxt->elem == 0) {
         xmlRelaxNGPtr schema;
         xmlRelaxNGGrammarPtr grammar;
@@ -8083,7 +9499,7 @@ xmlRelaxNGValidatePushElement(xmlRelaxNGValidCtxt *ctxt,
             ctxt->pdef = define;
             return (0);
         }
-        exec = xmlRegNewExecCtxt(define->contModel,
+        exec = xmlRegExecPoolGet(ctxt->execPool, define->contModel,
                                  xmlRelaxNGValidateProgressiveCallback,
                                  ctxt);
         if (exec == NULL) {
@@ -8096,13 +9512,8 @@ xmlRelaxNGValidatePushElement(xmlRelaxNGValidCtxt *ctxt,
 
     ctxt->pnode = elem;
     ctxt->pstate = 0;
-    if (elem->ns != NULL) {
-        ret =
-            xmlRegExecPushString2(ctxt->elem, elem->name, elem->ns->href,
-                                  ctxt);
-    } else {
-        ret = xmlRegExecPushString(ctxt->elem, elem->name, ctxt);
-    }
+    ret = xmlRegExecPushName(ctxt->elem, elem->name,
+                             elem->ns ? elem->ns->href : NULL, 0, ctxt);
     if (ret < 0) {
         VALID_ERR2(XML_RELAXNG_ERR_ELEMWRONG, elem->name);
         goto Recovery;
@@ -8141,6 +9552,14 @@ xmlRelaxNGValidatePushCData(xmlRelaxNGValidCtxt *ctxt,
     if ((ctxt == NULL) || (ctxt->elem == NULL) || (data == NULL))
         return (-1);
 
+    if (ctxt->pdata != NULL) {
+        ctxt->pvalue = xmlStrcat(ctxt->pvalue, data);
+        if (ctxt->pvalue == NULL) {
+            xmlRngVErrMemory(ctxt);
+            return (-1);
+        }
+    }
+
     while (*data != 0) {
         if (!IS_BLANK_CH(*data))
             break;
@@ -8159,40 +9578,119 @@ xmlRelaxNGValidatePushCData(xmlRelaxNGValidCtxt *ctxt,
 }
 
 /**
- * Pop the element end from the RelaxNG validation stack.
+ * Validate the text collected for an element with data content.
  *
  * @param ctxt  the RelaxNG validation context
- * @param doc  a document instance
- * @param elem  an element instance
- * @returns 1 if no validation problem was found or 0 otherwise
+ * @param elem  the element
+ * @returns 0 if the text is valid, -1 otherwise
  */
-int
-xmlRelaxNGValidatePopElement(xmlRelaxNGValidCtxt *ctxt,
-                             xmlDoc *doc ATTRIBUTE_UNUSED,
-                             xmlNode *elem)
+static int
+xmlRelaxNGValidateDataContent(xmlRelaxNGValidCtxtPtr ctxt, xmlNodePtr elem)
 {
-    int ret;
-    xmlRegExecCtxtPtr exec;
+    xmlRelaxNGDefinePtr define = ctxt->pdata;
+    xmlRelaxNGValidStatePtr state, oldstate = ctxt->state;
+    xmlNodePtr text = NULL;
+    int ret = -1, i;
 
-    if ((ctxt == NULL) || (ctxt->elem == NULL) || (elem == NULL))
-        return (-1);
+    ctxt->pdata = NULL;
+    state = xmlRelaxNGNewValidState(ctxt, elem);
+    if (state == NULL)
+        goto done;
     /*
-     * verify that we reached a terminal state of the content model.
+     * The children aren't available anymore, validate a text node
+     * standing for them. Attributes were validated at the start.
      */
-    exec = xmlRelaxNGElemPop(ctxt);
-    ret = xmlRegExecPushString(exec, NULL, NULL);
-    if (ret == 0) {
-        /*
-         * TODO: get some of the names needed to exit the current state of exec
-         */
-        VALID_ERR2(XML_RELAXNG_ERR_NOELEM, BAD_CAST "");
-        ret = -1;
+    if ((ctxt->pvalue != NULL) && (ctxt->pvalue[0] != 0)) {
+        text = xmlNewDocText(elem->doc, ctxt->pvalue);
+        if (text == NULL) {
+            xmlRngVErrMemory(ctxt);
+            xmlRelaxNGFreeValidState(ctxt, state);
+            goto done;
+        }
+        text->parent = elem;
+        text->line = elem->line;
+    }
+    state->seq = text;
+    state->nbAttrs = 0;
+    state->nbAttrLeft = 0;
+
+    ctxt->state = state;
+    ret = xmlRelaxNGValidateDefinitionList(ctxt, define->content);
+    if (ctxt->states != NULL) {
+        int tmp = -1;
+
+        for (i = 0; i < ctxt->states->nbState; i++) {
+            state = ctxt->states->tabState[i];
+            if (state->seq == NULL)
+                tmp = 0;
+            xmlRelaxNGFreeValidState(ctxt, state);
+        }
+        xmlRelaxNGFreeStates(ctxt, ctxt->states);
+        ctxt->states = NULL;
+        if (tmp != 0)
+            ret = -1;
+    } else if (ctxt->state != NULL) {
+        if (ctxt->state->seq != NULL)
+            ret = -1;
+        xmlRelaxNGFreeValidState(ctxt, ctxt->state);
+    }
+    ctxt->state = oldstate;
+    if (ret != 0) {
+        if (ctxt->errNr != 0)
+            xmlRelaxNGDumpValidError(ctxt);
+        xmlRelaxNGShowValidError(ctxt, XML_RELAXNG_ERR_CONTENTVALID, elem,
+                                 NULL, elem->name, NULL);
+    }
+
+done:
+    if (text != NULL) {
+        text->parent = NULL;
+        xmlFreeNode(text);
+    }
+    xmlFree(ctxt->pvalue);
+    ctxt->pvalue = NULL;
+    return (ret);
+}
+
+/**
+ * Pop the element end from the RelaxNG validation stack.
+ *
+ * @param ctxt  the RelaxNG validation context
+ * @param doc  a document instance
+ * @param elem  an element instance
+ * @returns 1 if no validation problem was found or 0 otherwise
+ */
+int
+xmlRelaxNGValidatePopElement(xmlRelaxNGValidCtxt *ctxt,
+                             xmlDoc *doc ATTRIBUTE_UNUSED,
+                             xmlNode *elem)
+{
+    int ret;
+    xmlRegExecCtxtPtr exec;
+
+    if ((ctxt == NULL) || (ctxt->elem == NULL) || (elem == NULL))
+        return (-1);
+    /*
+     * verify that we reached a terminal state of the content model.
+     */
+    exec = xmlRelaxNGElemPop(ctxt);
+    ctxt->pnode = elem;
+    ret = xmlRegExecPushString(exec, NULL, NULL);
+    if (ret == 0) {
+        xmlChar name[100];
+
+        VALID_ERR2P(XML_RELAXNG_ERR_NOELEM,
+                    xmlRelaxNGExpectedElement(exec, name, sizeof(name)));
+        ret = -1;
     } else if (ret < 0) {
         ret = -1;
     } else {
         ret = 1;
     }
-    xmlRegFreeExecCtxt(exec);
+    xmlRegExecPoolPut(ctxt->execPool, exec);
+    if ((ctxt->pdata != NULL) &&
+        (xmlRelaxNGValidateDataContent(ctxt, elem) != 0))
+        ret = -1;
     return (ret);
 }
 
@@ -8352,7 +9850,13 @@ xmlRelaxNGValidateDatatype(xmlRelaxNGValidCtxtPtr ctxt,
         return (-1);
     }
     lib = (xmlRelaxNGTypeLibraryPtr) define->data;
-    if (lib->check != NULL) {
+    if ((define->compiled != NULL) && (lib->validate != NULL)) {
+        ret = lib->validate(lib->data, define->compiled, value, node);
+        if (ret == 3) {
+            /* rejected by a param, reported like the uncompiled path */
+            return (-1);
+        }
+    } else if (lib->check != NULL) {
         if ((define->attrs != NULL) &&
             (define->attrs->type == XML_RELAXNG_PARAM)) {
             ret =
@@ -8375,7 +9879,7 @@ xmlRelaxNGValidateDatatype(xmlRelaxNGValidCtxtPtr ctxt,
         VALID_ERR3P(XML_RELAXNG_ERR_TYPEVAL, define->name, value);
         ret = -1;
     }
-    cur = define->attrs;
+    cur = (define->compiled != NULL) ? NULL : define->attrs;
     while ((ret == 0) && (cur != NULL) && (cur->type == XML_RELAXNG_PARAM)) {
         if (lib->facet != NULL) {
             tmp = lib->facet(lib->data, define->name, cur->name,
@@ -8941,6 +10445,66 @@ xmlRelaxNGValidateAttributeList(xmlRelaxNGValidCtxtPtr ctxt,
     return (ret);
 }
 
+/**
+ * Validate the attributes found in the content of an element which
+ * were left out of its compiled content model.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param defines  the list of content definitions
+ * @returns 0 if the validation succeeded or an error code.
+ */
+static int
+xmlRelaxNGValidateContentAttributes(xmlRelaxNGValidCtxtPtr ctxt,
+                                    xmlRelaxNGDefinePtr defines)
+{
+    int ret = 0, res;
+    xmlRelaxNGDefinePtr cur;
+
+    for (cur = defines; cur != NULL; cur = cur->next) {
+        if (cur->type == XML_RELAXNG_ELEMENT)
+            continue;
+        if (cur->dflags & IS_ATTRS_ONLY) {
+            if ((ctxt->state == NULL) && (ctxt->states == NULL)) {
+                VALID_ERR(XML_RELAXNG_ERR_NOSTATE);
+                return (-1);
+            }
+            res = xmlRelaxNGValidateDefinition(ctxt, cur);
+            if (res < 0)
+                ret = -1;
+            if (res == -1)
+                break;
+        } else if (cur->dflags & HAS_CONTENT_ATTRS) {
+            if (xmlRelaxNGValidateContentAttributes(ctxt, cur->content) != 0)
+                ret = -1;
+        }
+    }
+
+    return (ret);
+}
+
+/**
+ * Validate the attributes of an element, including the ones validated
+ * apart from its compiled content model.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param define  the element definition
+ * @returns 0 if the validation succeeded or an error code.
+ */
+static int
+xmlRelaxNGValidateElementAttributes(xmlRelaxNGValidCtxtPtr ctxt,
+                                    xmlRelaxNGDefinePtr define)
+{
+    int ret = 0;
+
+    if (define->attrs != NULL)
+        ret = xmlRelaxNGValidateAttributeList(ctxt, define->attrs);
+    if ((define->dflags & HAS_CONTENT_ATTRS) && (define->contModel != NULL) &&
+        (xmlRelaxNGValidateContentAttributes(ctxt, define->content) != 0))
+        ret = -1;
+
+    return (ret);
+}
+
 /**
  * Check if a node can be matched by one of the definitions
  *
@@ -9649,14 +11213,16 @@ xmlRelaxNGValidateState(xmlRelaxNGValidCtxtPtr ctxt,
 
             oldstate = ctxt->state;
             ctxt->state = state;
-            if (define->attrs != NULL) {
-                tmp = xmlRelaxNGValidateAttributeList(ctxt, define->attrs);
+            if ((define->attrs != NULL) ||
+                (define->dflags & HAS_CONTENT_ATTRS)) {
+                tmp = xmlRelaxNGValidateElementAttributes(ctxt, define);
                 if (tmp != 0) {
                     ret = -1;
                     VALID_ERR2(XML_RELAXNG_ERR_ATTRVALID, node->name);
                 }
             }
-            if (define->contModel != NULL) {
+            if ((define->contModel != NULL) &&
+                ((define->dflags & IS_DATA_CONTENT) == 0)) {
                 xmlRelaxNGValidStatePtr nstate, tmpstate = ctxt->state;
                 xmlRelaxNGStatesPtr tmpstates = ctxt->states;
                 xmlNodePtr nseq;
@@ -9961,6 +11527,7 @@ xmlRelaxNGValidateState(xmlRelaxNGValidCtxtPtr ctxt,
 				}
                             }
                             states->nbState = 0;
+                            states->nbHashed = -1;
                             for (i = base; i < res->nbState; i++)
                                 xmlRelaxNGAddStates(ctxt, states,
                                                     xmlRelaxNGCopyValidState
@@ -10253,134 +11820,1269 @@ xmlRelaxNGValidateState(xmlRelaxNGValidCtxtPtr ctxt,
 }
 
 /**
- * Validate the current node lists against the definition
+ * Validate the current node lists against the definition
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param define  the definition to verify
+ * @returns 0 if the validation succeeded or an error code.
+ */
+static int
+xmlRelaxNGValidateDefinition(xmlRelaxNGValidCtxtPtr ctxt,
+                             xmlRelaxNGDefinePtr define)
+{
+    xmlRelaxNGStatesPtr states, res;
+    int i, j, k, ret, oldflags;
+
+    /*
+     * We should NOT have both ctxt->state and ctxt->states
+     */
+    if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
+        /* TODO */
+        xmlRelaxNGFreeValidState(ctxt, ctxt->state);
+        ctxt->state = NULL;
+    }
+
+    if ((ctxt->states == NULL) || (ctxt->states->nbState == 1)) {
+        if (ctxt->states != NULL) {
+            ctxt->state = ctxt->states->tabState[0];
+            xmlRelaxNGFreeStates(ctxt, ctxt->states);
+            ctxt->states = NULL;
+        }
+        ret = xmlRelaxNGValidateState(ctxt, define);
+        if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
+            /* TODO */
+            xmlRelaxNGFreeValidState(ctxt, ctxt->state);
+            ctxt->state = NULL;
+        }
+        if ((ctxt->states != NULL) && (ctxt->states->nbState == 1)) {
+            ctxt->state = ctxt->states->tabState[0];
+            xmlRelaxNGFreeStates(ctxt, ctxt->states);
+            ctxt->states = NULL;
+        }
+        return (ret);
+    }
+
+    states = ctxt->states;
+    ctxt->states = NULL;
+    res = NULL;
+    j = 0;
+    oldflags = ctxt->flags;
+    ctxt->flags |= FLAGS_IGNORABLE;
+    for (i = 0; i < states->nbState; i++) {
+        ctxt->state = states->tabState[i];
+        ctxt->states = NULL;
+        ret = xmlRelaxNGValidateState(ctxt, define);
+        /*
+         * We should NOT have both ctxt->state and ctxt->states
+         */
+        if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
+            /* TODO */
+            xmlRelaxNGFreeValidState(ctxt, ctxt->state);
+            ctxt->state = NULL;
+        }
+        if (ret == 0) {
+            if (ctxt->states == NULL) {
+                if (res != NULL) {
+                    /* add the state to the container */
+                    xmlRelaxNGAddStates(ctxt, res, ctxt->state);
+                    ctxt->state = NULL;
+                } else {
+                    /* add the state directly in states */
+                    states->tabState[j++] = ctxt->state;
+                    ctxt->state = NULL;
+                }
+            } else {
+                if (res == NULL) {
+                    /* make it the new container and copy other results */
+                    res = ctxt->states;
+                    ctxt->states = NULL;
+                    for (k = 0; k < j; k++)
+                        xmlRelaxNGAddStates(ctxt, res,
+                                            states->tabState[k]);
+                } else {
+                    /* add all the new results to res and reff the container */
+                    for (k = 0; k < ctxt->states->nbState; k++)
+                        xmlRelaxNGAddStates(ctxt, res,
+                                            ctxt->states->tabState[k]);
+                    xmlRelaxNGFreeStates(ctxt, ctxt->states);
+                    ctxt->states = NULL;
+                }
+            }
+        } else {
+            if (ctxt->state != NULL) {
+                xmlRelaxNGFreeValidState(ctxt, ctxt->state);
+                ctxt->state = NULL;
+            } else if (ctxt->states != NULL) {
+                for (k = 0; k < ctxt->states->nbState; k++)
+                    xmlRelaxNGFreeValidState(ctxt,
+                                             ctxt->states->tabState[k]);
+                xmlRelaxNGFreeStates(ctxt, ctxt->states);
+                ctxt->states = NULL;
+            }
+        }
+    }
+    ctxt->flags = oldflags;
+    if (res != NULL) {
+        xmlRelaxNGFreeStates(ctxt, states);
+        ctxt->states = res;
+        ret = 0;
+    } else if (j > 1) {
+        states->nbState = j;
+        states->nbHashed = -1;
+        ctxt->states = states;
+        ret = 0;
+    } else if (j == 1) {
+        ctxt->state = states->tabState[0];
+        xmlRelaxNGFreeStates(ctxt, states);
+        ret = 0;
+    } else {
+        ret = -1;
+        xmlRelaxNGFreeStates(ctxt, states);
+        if (ctxt->states != NULL) {
+            xmlRelaxNGFreeStates(ctxt, ctxt->states);
+            ctxt->states = NULL;
+        }
+    }
+    if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
+        /* TODO */
+        xmlRelaxNGFreeValidState(ctxt, ctxt->state);
+        ctxt->state = NULL;
+    }
+    return (ret);
+}
+
+/************************************************************************
+ *									*
+ *		Validation with pattern derivatives			*
+ *									*
+ ************************************************************************/
+
+/*
+ * An alternative validation engine computing the derivatives of
+ * patterns with respect to start tags, attributes, text and end tags
+ * as described in James Clark's "An algorithm for RELAX NG
+ * validation". Patterns are hash-consed so equal patterns are
+ * identical and derivatives can be memoized by address. The cost of
+ * choices and interleaves is bounded by the size of the patterns
+ * instead of the number of ways to match them. Datatypes, values and
+ * lists are still checked with xmlRelaxNGValidateValue.
+ */
+
+typedef enum {
+    XML_RELAXNG_PAT_EMPTY = 1,
+    XML_RELAXNG_PAT_NOT_ALLOWED,
+    XML_RELAXNG_PAT_TEXT,
+    XML_RELAXNG_PAT_CHOICE,
+    XML_RELAXNG_PAT_INTERLEAVE,
+    XML_RELAXNG_PAT_GROUP,
+    XML_RELAXNG_PAT_ONEORMORE,
+    XML_RELAXNG_PAT_DATA,       /* a datatype, value or list */
+    XML_RELAXNG_PAT_ATTRIBUTE,
+    XML_RELAXNG_PAT_ELEMENT,
+    XML_RELAXNG_PAT_AFTER
+} xmlRelaxNGPatType;
+
+/*
+ * Memoized operations, pattern construction uses the pattern type
+ */
+#define XML_RELAXNG_OP_CONVERT		20
+#define XML_RELAXNG_OP_CONTENT		21
+#define XML_RELAXNG_OP_START_OPEN	22
+#define XML_RELAXNG_OP_START_CLOSE	23
+#define XML_RELAXNG_OP_START_RECOVER	24
+#define XML_RELAXNG_OP_END		25
+#define XML_RELAXNG_OP_TEXT		26
+/* applyAfter with the functions group(p, x), interleave(p, x),
+   interleave(x, p) and after(p, x) */
+#define XML_RELAXNG_OP_AFTER_GROUP	27
+#define XML_RELAXNG_OP_AFTER_ILEAVE	28
+#define XML_RELAXNG_OP_AFTER_ILEAVE_REV	29
+#define XML_RELAXNG_OP_AFTER_AFTER	30
+
+/* Flush the memo table between documents once it got that big */
+#define XML_RELAXNG_MAX_MEMO (1 << 20)
+
+typedef struct _xmlRelaxNGPat xmlRelaxNGPat;
+typedef xmlRelaxNGPat *xmlRelaxNGPatPtr;
+struct _xmlRelaxNGPat {
+    xmlRelaxNGPatType type;
+    short nullable;             /* matches the empty sequence */
+    short flags;                /* XML_RELAXNG_PAT_HAS_* */
+    xmlRelaxNGPatPtr p1;
+    xmlRelaxNGPatPtr p2;
+    xmlRelaxNGDefinePtr def;    /* data, attribute or element define */
+};
+
+#define XML_RELAXNG_PAT_HAS_DATA	(1 << 0)
+#define XML_RELAXNG_PAT_HAS_ATTR	(1 << 1)
+
+#define XML_RELAXNG_PAT_BLOCK 256
+
+typedef struct _xmlRelaxNGPatBlock xmlRelaxNGPatBlock;
+struct _xmlRelaxNGPatBlock {
+    xmlRelaxNGPatBlock *next;
+    xmlRelaxNGPat pats[XML_RELAXNG_PAT_BLOCK];
+};
+
+typedef struct {
+    int op;                     /* 0 if the slot is free */
+    const void *a;
+    const void *b;
+    const void *c;
+    xmlRelaxNGPatPtr res;
+} xmlRelaxNGMemo;
+
+struct _xmlRelaxNGDeriv {
+    xmlRelaxNGMemo *memo;       /* interned patterns and derivatives */
+    unsigned memoSize;          /* a power of two */
+    unsigned nbMemo;
+    xmlRelaxNGPatBlock *blocks;
+    int nbUsed;                 /* patterns used in the first block */
+    xmlDictPtr dict;            /* element names used as memo keys */
+    xmlRelaxNGPatPtr empty;
+    xmlRelaxNGPatPtr notAllowed;
+    xmlRelaxNGPatPtr text;
+};
+
+static void
+xmlRelaxNGFreeDeriv(xmlRelaxNGDerivPtr deriv)
+{
+    xmlRelaxNGPatBlock *block, *next;
+
+    if (deriv == NULL)
+        return;
+    for (block = deriv->blocks; block != NULL; block = next) {
+        next = block->next;
+        xmlFree(block);
+    }
+    xmlFree(deriv->memo);
+    xmlDictFree(deriv->dict);
+    xmlFree(deriv);
+}
+
+static unsigned
+xmlRelaxNGMemoHash(int op, const void *a, const void *b, const void *c)
+{
+    size_t h;
+
+    h = (size_t) op;
+    h = h * 0x9E3779B1u + (size_t) a;
+    h = h * 0x9E3779B1u + (size_t) b;
+    h = h * 0x9E3779B1u + (size_t) c;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+
+    return ((unsigned) h);
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGMemoGet(xmlRelaxNGDerivPtr deriv, int op, const void *a,
+                  const void *b, const void *c)
+{
+    xmlRelaxNGMemo *entry;
+    unsigned mask = deriv->memoSize - 1;
+    unsigned pos = xmlRelaxNGMemoHash(op, a, b, c) & mask;
+
+    while (1) {
+        entry = &deriv->memo[pos];
+        if (entry->op == 0)
+            return (NULL);
+        if ((entry->op == op) && (entry->a == a) && (entry->b == b) &&
+            (entry->c == c))
+            return (entry->res);
+        pos = (pos + 1) & mask;
+    }
+}
+
+static int
+xmlRelaxNGMemoPut(xmlRelaxNGValidCtxtPtr ctxt, int op, const void *a,
+                  const void *b, const void *c, xmlRelaxNGPatPtr res)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGMemo *entry;
+    unsigned mask, pos;
+
+    if (2 * (deriv->nbMemo + 1) > deriv->memoSize) {
+        xmlRelaxNGMemo *old = deriv->memo, *tmp;
+        unsigned oldSize = deriv->memoSize, i;
+
+        tmp = xmlMalloc(2 * oldSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlRngVErrMemory(ctxt);
+            return (-1);
+        }
+        memset(tmp, 0, 2 * oldSize * sizeof(tmp[0]));
+        deriv->memo = tmp;
+        deriv->memoSize = 2 * oldSize;
+        mask = deriv->memoSize - 1;
+        for (i = 0; i < oldSize; i++) {
+            if (old[i].op == 0)
+                continue;
+            pos = xmlRelaxNGMemoHash(old[i].op, old[i].a, old[i].b,
+                                     old[i].c) & mask;
+            while (tmp[pos].op != 0)
+                pos = (pos + 1) & mask;
+            tmp[pos] = old[i];
+        }
+        xmlFree(old);
+    }
+
+    mask = deriv->memoSize - 1;
+    pos = xmlRelaxNGMemoHash(op, a, b, c) & mask;
+    while (deriv->memo[pos].op != 0)
+        pos = (pos + 1) & mask;
+    entry = &deriv->memo[pos];
+    entry->op = op;
+    entry->a = a;
+    entry->b = b;
+    entry->c = c;
+    entry->res = res;
+    deriv->nbMemo++;
+
+    return (0);
+}
+
+/**
+ * Return the unique pattern with the given type and components.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param type  the pattern type
+ * @param p1  the first sub-pattern
+ * @param p2  the second sub-pattern
+ * @param def  the define of leaf patterns
+ * @returns the pattern or NotAllowed in case of error.
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatGet(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatType type,
+                 xmlRelaxNGPatPtr p1, xmlRelaxNGPatPtr p2,
+                 xmlRelaxNGDefinePtr def)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGPatPtr ret;
+
+    ret = xmlRelaxNGMemoGet(deriv, type, p1, p2, def);
+    if (ret != NULL)
+        return (ret);
+
+    if ((deriv->blocks == NULL) ||
+        (deriv->nbUsed >= XML_RELAXNG_PAT_BLOCK)) {
+        xmlRelaxNGPatBlock *block;
+
+        block = xmlMalloc(sizeof(*block));
+        if (block == NULL) {
+            xmlRngVErrMemory(ctxt);
+            return (deriv->notAllowed);
+        }
+        block->next = deriv->blocks;
+        deriv->blocks = block;
+        deriv->nbUsed = 0;
+    }
+    ret = &deriv->blocks->pats[deriv->nbUsed++];
+    ret->type = type;
+    ret->p1 = p1;
+    ret->p2 = p2;
+    ret->def = def;
+    ret->flags = 0;
+    if (p1 != NULL)
+        ret->flags |= p1->flags;
+    if (p2 != NULL)
+        ret->flags |= p2->flags;
+    switch (type) {
+        case XML_RELAXNG_PAT_EMPTY:
+        case XML_RELAXNG_PAT_TEXT:
+            ret->nullable = 1;
+            break;
+        case XML_RELAXNG_PAT_CHOICE:
+            ret->nullable = p1->nullable || p2->nullable;
+            break;
+        case XML_RELAXNG_PAT_INTERLEAVE:
+        case XML_RELAXNG_PAT_GROUP:
+            ret->nullable = p1->nullable && p2->nullable;
+            break;
+        case XML_RELAXNG_PAT_ONEORMORE:
+            ret->nullable = p1->nullable;
+            break;
+        case XML_RELAXNG_PAT_DATA:
+            ret->nullable = 0;
+            ret->flags = XML_RELAXNG_PAT_HAS_DATA;
+            break;
+        case XML_RELAXNG_PAT_ATTRIBUTE:
+            ret->nullable = 0;
+            ret->flags = XML_RELAXNG_PAT_HAS_ATTR;
+            break;
+        case XML_RELAXNG_PAT_AFTER:
+            /* Attributes of the parent were already closed */
+            ret->nullable = 0;
+            ret->flags = p1->flags;
+            break;
+        default:
+            ret->nullable = 0;
+            break;
+    }
+    if (xmlRelaxNGMemoPut(ctxt, type, p1, p2, def, ret) < 0)
+        return (deriv->notAllowed);
+
+    return (ret);
+}
+
+static int
+xmlRelaxNGPatHasChoice(xmlRelaxNGPatPtr p, xmlRelaxNGPatPtr alt)
+{
+    while (p->type == XML_RELAXNG_PAT_CHOICE) {
+        if ((p->p2 == alt) || (xmlRelaxNGPatHasChoice(p->p2, alt)))
+            return (1);
+        p = p->p1;
+    }
+    return (p == alt);
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatChoice(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p1,
+                    xmlRelaxNGPatPtr p2)
+{
+    if (p1->type == XML_RELAXNG_PAT_NOT_ALLOWED)
+        return (p2);
+    if (p2->type == XML_RELAXNG_PAT_NOT_ALLOWED)
+        return (p1);
+    if (xmlRelaxNGPatHasChoice(p1, p2))
+        return (p1);
+    if (xmlRelaxNGPatHasChoice(p2, p1))
+        return (p2);
+    return (xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_CHOICE, p1, p2, NULL));
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatGroup(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p1,
+                   xmlRelaxNGPatPtr p2)
+{
+    if ((p1->type == XML_RELAXNG_PAT_NOT_ALLOWED) ||
+        (p2->type == XML_RELAXNG_PAT_NOT_ALLOWED))
+        return (ctxt->deriv->notAllowed);
+    if (p1->type == XML_RELAXNG_PAT_EMPTY)
+        return (p2);
+    if (p2->type == XML_RELAXNG_PAT_EMPTY)
+        return (p1);
+    return (xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_GROUP, p1, p2, NULL));
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatInterleave(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p1,
+                        xmlRelaxNGPatPtr p2)
+{
+    if ((p1->type == XML_RELAXNG_PAT_NOT_ALLOWED) ||
+        (p2->type == XML_RELAXNG_PAT_NOT_ALLOWED))
+        return (ctxt->deriv->notAllowed);
+    if (p1->type == XML_RELAXNG_PAT_EMPTY)
+        return (p2);
+    if (p2->type == XML_RELAXNG_PAT_EMPTY)
+        return (p1);
+    /* interleave is commutative */
+    if (p1 > p2) {
+        xmlRelaxNGPatPtr tmp = p1;
+
+        p1 = p2;
+        p2 = tmp;
+    }
+    return (xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_INTERLEAVE, p1, p2,
+                             NULL));
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatAfter(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p1,
+                   xmlRelaxNGPatPtr p2)
+{
+    if ((p1->type == XML_RELAXNG_PAT_NOT_ALLOWED) ||
+        (p2->type == XML_RELAXNG_PAT_NOT_ALLOWED))
+        return (ctxt->deriv->notAllowed);
+    return (xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_AFTER, p1, p2, NULL));
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatOneOrMore(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p)
+{
+    if ((p->type == XML_RELAXNG_PAT_NOT_ALLOWED) ||
+        (p->type == XML_RELAXNG_PAT_EMPTY) ||
+        (p->type == XML_RELAXNG_PAT_ONEORMORE))
+        return (p);
+    return (xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_ONEORMORE, p, NULL,
+                             NULL));
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatConvert(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGDefinePtr def);
+
+/**
+ * Convert a list of defines combined with the given pattern type.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param defs  the list of defines
+ * @param type  group, choice or interleave
+ * @returns the pattern
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatConvertList(xmlRelaxNGValidCtxtPtr ctxt,
+                         xmlRelaxNGDefinePtr defs, xmlRelaxNGPatType type)
+{
+    xmlRelaxNGPatPtr ret = NULL, cur;
+
+    for (; defs != NULL; defs = defs->next) {
+        cur = xmlRelaxNGPatConvert(ctxt, defs);
+        if (ret == NULL)
+            ret = cur;
+        else if (type == XML_RELAXNG_PAT_CHOICE)
+            ret = xmlRelaxNGPatChoice(ctxt, ret, cur);
+        else if (type == XML_RELAXNG_PAT_INTERLEAVE)
+            ret = xmlRelaxNGPatInterleave(ctxt, ret, cur);
+        else
+            ret = xmlRelaxNGPatGroup(ctxt, ret, cur);
+    }
+    if (ret == NULL) {
+        if (type == XML_RELAXNG_PAT_CHOICE)
+            return (ctxt->deriv->notAllowed);
+        return (ctxt->deriv->empty);
+    }
+    return (ret);
+}
+
+/**
+ * Convert a compiled define into a pattern. The content of elements
+ * and attributes is converted on demand.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param def  the define
+ * @returns the pattern
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatConvert(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGPatPtr ret;
+
+    if (def == NULL)
+        return (deriv->notAllowed);
+    ret = xmlRelaxNGMemoGet(deriv, XML_RELAXNG_OP_CONVERT, def, NULL, NULL);
+    if (ret != NULL)
+        return (ret);
+
+    switch (def->type) {
+        case XML_RELAXNG_EMPTY:
+            ret = deriv->empty;
+            break;
+        case XML_RELAXNG_TEXT:
+            ret = deriv->text;
+            break;
+        case XML_RELAXNG_ELEMENT:
+            ret = xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_ELEMENT,
+                                   NULL, NULL, def);
+            break;
+        case XML_RELAXNG_ATTRIBUTE:
+            ret = xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_ATTRIBUTE,
+                                   NULL, NULL, def);
+            break;
+        case XML_RELAXNG_DATATYPE:
+        case XML_RELAXNG_VALUE:
+        case XML_RELAXNG_LIST:
+            ret = xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_DATA,
+                                   NULL, NULL, def);
+            break;
+        case XML_RELAXNG_DEF:
+        case XML_RELAXNG_GROUP:
+            ret = xmlRelaxNGPatConvertList(ctxt, def->content,
+                                           XML_RELAXNG_PAT_GROUP);
+            break;
+        case XML_RELAXNG_CHOICE:
+            ret = xmlRelaxNGPatConvertList(ctxt, def->content,
+                                           XML_RELAXNG_PAT_CHOICE);
+            break;
+        case XML_RELAXNG_INTERLEAVE:
+            ret = xmlRelaxNGPatConvertList(ctxt, def->content,
+                                           XML_RELAXNG_PAT_INTERLEAVE);
+            break;
+        case XML_RELAXNG_OPTIONAL:
+            ret = xmlRelaxNGPatConvertList(ctxt, def->content,
+                                           XML_RELAXNG_PAT_GROUP);
+            ret = xmlRelaxNGPatChoice(ctxt, ret, deriv->empty);
+            break;
+        case XML_RELAXNG_ZEROORMORE:
+            ret = xmlRelaxNGPatConvertList(ctxt, def->content,
+                                           XML_RELAXNG_PAT_GROUP);
+            ret = xmlRelaxNGPatOneOrMore(ctxt, ret);
+            ret = xmlRelaxNGPatChoice(ctxt, ret, deriv->empty);
+            break;
+        case XML_RELAXNG_ONEORMORE:
+            ret = xmlRelaxNGPatConvertList(ctxt, def->content,
+                                           XML_RELAXNG_PAT_GROUP);
+            ret = xmlRelaxNGPatOneOrMore(ctxt, ret);
+            break;
+        case XML_RELAXNG_REF:
+        case XML_RELAXNG_EXTERNALREF:
+        case XML_RELAXNG_PARENTREF:
+        case XML_RELAXNG_START:
+        case XML_RELAXNG_NOOP:
+            ret = xmlRelaxNGPatConvert(ctxt, def->content);
+            break;
+        default:
+            ret = deriv->notAllowed;
+            break;
+    }
+    xmlRelaxNGMemoPut(ctxt, XML_RELAXNG_OP_CONVERT, def, NULL, NULL, ret);
+
+    return (ret);
+}
+
+/**
+ * Get the pattern for the content of an element or attribute define.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param def  the element or attribute define
+ * @returns the pattern
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatContent(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGDefinePtr def)
+{
+    xmlRelaxNGPatPtr ret;
+
+    ret = xmlRelaxNGMemoGet(ctxt->deriv, XML_RELAXNG_OP_CONTENT, def,
+                            NULL, NULL);
+    if (ret != NULL)
+        return (ret);
+
+    if (def->type == XML_RELAXNG_ELEMENT) {
+        ret = xmlRelaxNGPatGroup(ctxt,
+                xmlRelaxNGPatConvertList(ctxt, def->attrs,
+                                         XML_RELAXNG_PAT_GROUP),
+                xmlRelaxNGPatConvertList(ctxt, def->content,
+                                         XML_RELAXNG_PAT_GROUP));
+    } else if (def->content == NULL) {
+        /* <attribute> defaults to <text> */
+        ret = ctxt->deriv->text;
+    } else {
+        ret = xmlRelaxNGPatConvertList(ctxt, def->content,
+                                       XML_RELAXNG_PAT_GROUP);
+    }
+    xmlRelaxNGMemoPut(ctxt, XML_RELAXNG_OP_CONTENT, def, NULL, NULL, ret);
+
+    return (ret);
+}
+
+/**
+ * Replace the second component of the After patterns in `p` with
+ * the result of applying a function described by `op` and `x`.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param op  one of XML_RELAXNG_OP_AFTER_*
+ * @param p  the pattern
+ * @param x  the argument of the function
+ * @returns the pattern
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatApplyAfter(xmlRelaxNGValidCtxtPtr ctxt, int op,
+                        xmlRelaxNGPatPtr p, xmlRelaxNGPatPtr x)
+{
+    xmlRelaxNGPatPtr ret, q;
+
+    if (p->type == XML_RELAXNG_PAT_NOT_ALLOWED)
+        return (p);
+    ret = xmlRelaxNGMemoGet(ctxt->deriv, op, p, x, NULL);
+    if (ret != NULL)
+        return (ret);
+
+    if (p->type == XML_RELAXNG_PAT_AFTER) {
+        switch (op) {
+            case XML_RELAXNG_OP_AFTER_GROUP:
+                q = xmlRelaxNGPatGroup(ctxt, p->p2, x);
+                break;
+            case XML_RELAXNG_OP_AFTER_ILEAVE:
+            case XML_RELAXNG_OP_AFTER_ILEAVE_REV:
+                q = xmlRelaxNGPatInterleave(ctxt, p->p2, x);
+                break;
+            default:
+                q = xmlRelaxNGPatAfter(ctxt, p->p2, x);
+                break;
+        }
+        ret = xmlRelaxNGPatAfter(ctxt, p->p1, q);
+    } else if (p->type == XML_RELAXNG_PAT_CHOICE) {
+        ret = xmlRelaxNGPatChoice(ctxt,
+                xmlRelaxNGPatApplyAfter(ctxt, op, p->p1, x),
+                xmlRelaxNGPatApplyAfter(ctxt, op, p->p2, x));
+    } else {
+        ret = ctxt->deriv->notAllowed;
+    }
+    xmlRelaxNGMemoPut(ctxt, op, p, x, NULL, ret);
+
+    return (ret);
+}
+
+/**
+ * Derivative with respect to the start of an element.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param p  the pattern
+ * @param elem  the element
+ * @param name  the interned element name
+ * @param ns  the interned namespace name or NULL
+ * @returns the derivative
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatStartOpen(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                       xmlNodePtr elem, const xmlChar *name,
+                       const xmlChar *ns)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGPatPtr ret;
+
+    switch (p->type) {
+        case XML_RELAXNG_PAT_CHOICE:
+        case XML_RELAXNG_PAT_INTERLEAVE:
+        case XML_RELAXNG_PAT_GROUP:
+        case XML_RELAXNG_PAT_ONEORMORE:
+        case XML_RELAXNG_PAT_ELEMENT:
+        case XML_RELAXNG_PAT_AFTER:
+            break;
+        default:
+            return (deriv->notAllowed);
+    }
+    ret = xmlRelaxNGMemoGet(deriv, XML_RELAXNG_OP_START_OPEN, p, name, ns);
+    if (ret != NULL)
+        return (ret);
+
+    switch (p->type) {
+        case XML_RELAXNG_PAT_CHOICE:
+            ret = xmlRelaxNGPatChoice(ctxt,
+                    xmlRelaxNGPatStartOpen(ctxt, p->p1, elem, name, ns),
+                    xmlRelaxNGPatStartOpen(ctxt, p->p2, elem, name, ns));
+            break;
+        case XML_RELAXNG_PAT_INTERLEAVE:
+            ret = xmlRelaxNGPatChoice(ctxt,
+                    xmlRelaxNGPatApplyAfter(ctxt,
+                        XML_RELAXNG_OP_AFTER_ILEAVE,
+                        xmlRelaxNGPatStartOpen(ctxt, p->p1, elem, name, ns),
+                        p->p2),
+                    xmlRelaxNGPatApplyAfter(ctxt,
+                        XML_RELAXNG_OP_AFTER_ILEAVE_REV,
+                        xmlRelaxNGPatStartOpen(ctxt, p->p2, elem, name, ns),
+                        p->p1));
+            break;
+        case XML_RELAXNG_PAT_GROUP:
+            ret = xmlRelaxNGPatApplyAfter(ctxt, XML_RELAXNG_OP_AFTER_GROUP,
+                    xmlRelaxNGPatStartOpen(ctxt, p->p1, elem, name, ns),
+                    p->p2);
+            if (p->p1->nullable)
+                ret = xmlRelaxNGPatChoice(ctxt, ret,
+                        xmlRelaxNGPatStartOpen(ctxt, p->p2, elem, name, ns));
+            break;
+        case XML_RELAXNG_PAT_ONEORMORE:
+            ret = xmlRelaxNGPatApplyAfter(ctxt, XML_RELAXNG_OP_AFTER_GROUP,
+                    xmlRelaxNGPatStartOpen(ctxt, p->p1, elem, name, ns),
+                    xmlRelaxNGPatChoice(ctxt, p, deriv->empty));
+            break;
+        case XML_RELAXNG_PAT_ELEMENT:
+            if (xmlRelaxNGElementMatch(NULL, p->def, elem) == 1)
+                ret = xmlRelaxNGPatAfter(ctxt,
+                        xmlRelaxNGPatContent(ctxt, p->def), deriv->empty);
+            else
+                ret = deriv->notAllowed;
+            break;
+        default:
+            ret = xmlRelaxNGPatApplyAfter(ctxt, XML_RELAXNG_OP_AFTER_AFTER,
+                    xmlRelaxNGPatStartOpen(ctxt, p->p1, elem, name, ns),
+                    p->p2);
+            break;
+    }
+    xmlRelaxNGMemoPut(ctxt, XML_RELAXNG_OP_START_OPEN, p, name, ns, ret);
+
+    return (ret);
+}
+
+/**
+ * Derivative with respect to the end of a start tag. Attributes
+ * which weren't matched are NotAllowed or, when recovering from a
+ * missing attribute, ignored.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param p  the pattern
+ * @param recover  ignore missing attributes
+ * @returns the derivative
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatStartClose(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                        int recover)
+{
+    int op = recover ? XML_RELAXNG_OP_START_RECOVER :
+                       XML_RELAXNG_OP_START_CLOSE;
+    xmlRelaxNGPatPtr ret;
+
+    if ((p->flags & XML_RELAXNG_PAT_HAS_ATTR) == 0)
+        return (p);
+    ret = xmlRelaxNGMemoGet(ctxt->deriv, op, p, NULL, NULL);
+    if (ret != NULL)
+        return (ret);
+
+    switch (p->type) {
+        case XML_RELAXNG_PAT_AFTER:
+            ret = xmlRelaxNGPatAfter(ctxt,
+                    xmlRelaxNGPatStartClose(ctxt, p->p1, recover), p->p2);
+            break;
+        case XML_RELAXNG_PAT_CHOICE:
+            ret = xmlRelaxNGPatChoice(ctxt,
+                    xmlRelaxNGPatStartClose(ctxt, p->p1, recover),
+                    xmlRelaxNGPatStartClose(ctxt, p->p2, recover));
+            break;
+        case XML_RELAXNG_PAT_GROUP:
+            ret = xmlRelaxNGPatGroup(ctxt,
+                    xmlRelaxNGPatStartClose(ctxt, p->p1, recover),
+                    xmlRelaxNGPatStartClose(ctxt, p->p2, recover));
+            break;
+        case XML_RELAXNG_PAT_INTERLEAVE:
+            ret = xmlRelaxNGPatInterleave(ctxt,
+                    xmlRelaxNGPatStartClose(ctxt, p->p1, recover),
+                    xmlRelaxNGPatStartClose(ctxt, p->p2, recover));
+            break;
+        case XML_RELAXNG_PAT_ONEORMORE:
+            ret = xmlRelaxNGPatOneOrMore(ctxt,
+                    xmlRelaxNGPatStartClose(ctxt, p->p1, recover));
+            break;
+        case XML_RELAXNG_PAT_ATTRIBUTE:
+            ret = recover ? ctxt->deriv->empty : ctxt->deriv->notAllowed;
+            break;
+        default:
+            ret = p;
+            break;
+    }
+    xmlRelaxNGMemoPut(ctxt, op, p, NULL, NULL, ret);
+
+    return (ret);
+}
+
+/**
+ * Derivative with respect to an end tag. When recovering from
+ * missing content, the content left is ignored.
  *
  * @param ctxt  a Relax-NG validation context
- * @param define  the definition to verify
- * @returns 0 if the validation succeeded or an error code.
+ * @param p  the pattern
+ * @param recover  ignore missing content
+ * @returns the derivative
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatEnd(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                 int recover)
+{
+    xmlRelaxNGPatPtr ret;
+
+    if (p->type == XML_RELAXNG_PAT_AFTER) {
+        if ((p->p1->nullable) || (recover))
+            return (p->p2);
+        return (ctxt->deriv->notAllowed);
+    }
+    if (p->type != XML_RELAXNG_PAT_CHOICE)
+        return (ctxt->deriv->notAllowed);
+    if (recover)
+        return (xmlRelaxNGPatChoice(ctxt,
+                    xmlRelaxNGPatEnd(ctxt, p->p1, recover),
+                    xmlRelaxNGPatEnd(ctxt, p->p2, recover)));
+
+    ret = xmlRelaxNGMemoGet(ctxt->deriv, XML_RELAXNG_OP_END, p, NULL, NULL);
+    if (ret != NULL)
+        return (ret);
+    ret = xmlRelaxNGPatChoice(ctxt, xmlRelaxNGPatEnd(ctxt, p->p1, 0),
+                              xmlRelaxNGPatEnd(ctxt, p->p2, 0));
+    xmlRelaxNGMemoPut(ctxt, XML_RELAXNG_OP_END, p, NULL, NULL, ret);
+
+    return (ret);
+}
+
+/**
+ * Check a string against a datatype, value or list define.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param def  the define
+ * @param value  the string
+ * @param node  the element or attribute node
+ * @returns 1 if the value matches, 0 otherwise
  */
 static int
-xmlRelaxNGValidateDefinition(xmlRelaxNGValidCtxtPtr ctxt,
-                             xmlRelaxNGDefinePtr define)
+xmlRelaxNGPatCheckValue(xmlRelaxNGValidCtxtPtr ctxt,
+                        xmlRelaxNGDefinePtr def, const xmlChar *value,
+                        xmlNodePtr node)
 {
-    xmlRelaxNGStatesPtr states, res;
-    int i, j, k, ret, oldflags;
+    xmlRelaxNGValidState state;
+    xmlRelaxNGValidStatePtr oldstate = ctxt->state;
+    int oldflags = ctxt->flags, errNr = ctxt->errNr, errNo = ctxt->errNo;
+    int ret;
 
-    /*
-     * We should NOT have both ctxt->state and ctxt->states
-     */
-    if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
-        /* TODO */
-        xmlRelaxNGFreeValidState(ctxt, ctxt->state);
-        ctxt->state = NULL;
+    memset(&state, 0, sizeof(state));
+    state.node = node;
+    state.seq = node;
+    state.value = (xmlChar *) value;
+    ctxt->state = &state;
+    ctxt->flags |= FLAGS_IGNORABLE;
+    ret = xmlRelaxNGValidateValue(ctxt, def);
+    ctxt->flags = oldflags;
+    ctxt->state = oldstate;
+    ctxt->errNo = errNo;
+    if (ctxt->errNr > errNr)
+        xmlRelaxNGPopErrors(ctxt, errNr);
+
+    return (ret == 0);
+}
+
+/**
+ * Derivative with respect to a text.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param p  the pattern
+ * @param value  the text
+ * @param node  the node providing the namespace context
+ * @returns the derivative
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatText(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                  const xmlChar *value, xmlNodePtr node)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGPatPtr ret = NULL;
+    int memo = ((p->flags & XML_RELAXNG_PAT_HAS_DATA) == 0);
+
+    /* Without data patterns, the derivative doesn't depend on the text */
+    if (memo) {
+        if (p->type == XML_RELAXNG_PAT_TEXT)
+            return (p);
+        ret = xmlRelaxNGMemoGet(deriv, XML_RELAXNG_OP_TEXT, p, NULL, NULL);
+        if (ret != NULL)
+            return (ret);
     }
 
-    if ((ctxt->states == NULL) || (ctxt->states->nbState == 1)) {
-        if (ctxt->states != NULL) {
-            ctxt->state = ctxt->states->tabState[0];
-            xmlRelaxNGFreeStates(ctxt, ctxt->states);
-            ctxt->states = NULL;
-        }
-        ret = xmlRelaxNGValidateState(ctxt, define);
-        if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
-            /* TODO */
-            xmlRelaxNGFreeValidState(ctxt, ctxt->state);
-            ctxt->state = NULL;
-        }
-        if ((ctxt->states != NULL) && (ctxt->states->nbState == 1)) {
-            ctxt->state = ctxt->states->tabState[0];
-            xmlRelaxNGFreeStates(ctxt, ctxt->states);
-            ctxt->states = NULL;
-        }
-        return (ret);
+    switch (p->type) {
+        case XML_RELAXNG_PAT_CHOICE:
+            ret = xmlRelaxNGPatChoice(ctxt,
+                    xmlRelaxNGPatText(ctxt, p->p1, value, node),
+                    xmlRelaxNGPatText(ctxt, p->p2, value, node));
+            break;
+        case XML_RELAXNG_PAT_INTERLEAVE:
+            ret = xmlRelaxNGPatChoice(ctxt,
+                    xmlRelaxNGPatInterleave(ctxt,
+                        xmlRelaxNGPatText(ctxt, p->p1, value, node), p->p2),
+                    xmlRelaxNGPatInterleave(ctxt, p->p1,
+                        xmlRelaxNGPatText(ctxt, p->p2, value, node)));
+            break;
+        case XML_RELAXNG_PAT_GROUP:
+            ret = xmlRelaxNGPatGroup(ctxt,
+                    xmlRelaxNGPatText(ctxt, p->p1, value, node), p->p2);
+            if (p->p1->nullable)
+                ret = xmlRelaxNGPatChoice(ctxt, ret,
+                        xmlRelaxNGPatText(ctxt, p->p2, value, node));
+            break;
+        case XML_RELAXNG_PAT_AFTER:
+            ret = xmlRelaxNGPatAfter(ctxt,
+                    xmlRelaxNGPatText(ctxt, p->p1, value, node), p->p2);
+            break;
+        case XML_RELAXNG_PAT_ONEORMORE:
+            ret = xmlRelaxNGPatGroup(ctxt,
+                    xmlRelaxNGPatText(ctxt, p->p1, value, node),
+                    xmlRelaxNGPatChoice(ctxt, p, deriv->empty));
+            break;
+        case XML_RELAXNG_PAT_TEXT:
+            ret = p;
+            break;
+        case XML_RELAXNG_PAT_DATA:
+            if (xmlRelaxNGPatCheckValue(ctxt, p->def, value, node))
+                ret = deriv->empty;
+            else
+                ret = deriv->notAllowed;
+            break;
+        default:
+            ret = deriv->notAllowed;
+            break;
     }
+    if (memo)
+        xmlRelaxNGMemoPut(ctxt, XML_RELAXNG_OP_TEXT, p, NULL, NULL, ret);
 
-    states = ctxt->states;
-    ctxt->states = NULL;
-    res = NULL;
-    j = 0;
-    oldflags = ctxt->flags;
-    ctxt->flags |= FLAGS_IGNORABLE;
-    for (i = 0; i < states->nbState; i++) {
-        ctxt->state = states->tabState[i];
-        ctxt->states = NULL;
-        ret = xmlRelaxNGValidateState(ctxt, define);
-        /*
-         * We should NOT have both ctxt->state and ctxt->states
-         */
-        if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
-            /* TODO */
-            xmlRelaxNGFreeValidState(ctxt, ctxt->state);
-            ctxt->state = NULL;
+    return (ret);
+}
+
+/**
+ * Derivative with respect to an attribute.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param p  the pattern
+ * @param attr  the attribute
+ * @param value  the attribute value
+ * @returns the derivative
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatAttr(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                  xmlAttrPtr attr, const xmlChar *value)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGPatPtr content;
+
+    if ((p->flags & XML_RELAXNG_PAT_HAS_ATTR) == 0)
+        return (deriv->notAllowed);
+
+    switch (p->type) {
+        case XML_RELAXNG_PAT_AFTER:
+            return (xmlRelaxNGPatAfter(ctxt,
+                        xmlRelaxNGPatAttr(ctxt, p->p1, attr, value),
+                        p->p2));
+        case XML_RELAXNG_PAT_CHOICE:
+            return (xmlRelaxNGPatChoice(ctxt,
+                        xmlRelaxNGPatAttr(ctxt, p->p1, attr, value),
+                        xmlRelaxNGPatAttr(ctxt, p->p2, attr, value)));
+        case XML_RELAXNG_PAT_GROUP:
+            return (xmlRelaxNGPatChoice(ctxt,
+                        xmlRelaxNGPatGroup(ctxt,
+                            xmlRelaxNGPatAttr(ctxt, p->p1, attr, value),
+                            p->p2),
+                        xmlRelaxNGPatGroup(ctxt, p->p1,
+                            xmlRelaxNGPatAttr(ctxt, p->p2, attr, value))));
+        case XML_RELAXNG_PAT_INTERLEAVE:
+            return (xmlRelaxNGPatChoice(ctxt,
+                        xmlRelaxNGPatInterleave(ctxt,
+                            xmlRelaxNGPatAttr(ctxt, p->p1, attr, value),
+                            p->p2),
+                        xmlRelaxNGPatInterleave(ctxt, p->p1,
+                            xmlRelaxNGPatAttr(ctxt, p->p2, attr, value))));
+        case XML_RELAXNG_PAT_ONEORMORE:
+            return (xmlRelaxNGPatGroup(ctxt,
+                        xmlRelaxNGPatAttr(ctxt, p->p1, attr, value),
+                        xmlRelaxNGPatChoice(ctxt, p, deriv->empty)));
+        case XML_RELAXNG_PAT_ATTRIBUTE:
+            if (xmlRelaxNGAttributeMatch(NULL, p->def, attr) != 1)
+                return (deriv->notAllowed);
+            content = xmlRelaxNGPatContent(ctxt, p->def);
+            if ((content->nullable) && (xmlRelaxNGIsBlank((xmlChar *) value)))
+                return (deriv->empty);
+            if (xmlRelaxNGPatText(ctxt, content, value,
+                                  (xmlNodePtr) attr)->nullable)
+                return (deriv->empty);
+            return (deriv->notAllowed);
+        default:
+            return (deriv->notAllowed);
+    }
+}
+
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatElement(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                     xmlNodePtr elem);
+
+/**
+ * Derivative with respect to the children of an element. Whitespace
+ * is ignored between elements.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param p  the pattern
+ * @param elem  the element
+ * @returns the derivative
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatChildren(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                      xmlNodePtr elem)
+{
+    xmlRelaxNGPatPtr q;
+    xmlNodePtr cur, text = NULL;
+    xmlChar *buf = NULL;
+    const xmlChar *value;
+    int hasElem = 0;
+
+    for (cur = elem->children; cur != NULL; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            hasElem = 1;
+            break;
         }
-        if (ret == 0) {
-            if (ctxt->states == NULL) {
-                if (res != NULL) {
-                    /* add the state to the container */
-                    xmlRelaxNGAddStates(ctxt, res, ctxt->state);
-                    ctxt->state = NULL;
-                } else {
-                    /* add the state directly in states */
-                    states->tabState[j++] = ctxt->state;
-                    ctxt->state = NULL;
-                }
+    }
+
+    cur = elem->children;
+    while (1) {
+        /* Adjacent text is merged, skipping comments and PIs */
+        if ((cur != NULL) &&
+            ((cur->type == XML_TEXT_NODE) ||
+             (cur->type == XML_CDATA_SECTION_NODE))) {
+            if (text == NULL) {
+                text = cur;
             } else {
-                if (res == NULL) {
-                    /* make it the new container and copy other results */
-                    res = ctxt->states;
-                    ctxt->states = NULL;
-                    for (k = 0; k < j; k++)
-                        xmlRelaxNGAddStates(ctxt, res,
-                                            states->tabState[k]);
+                if (buf == NULL)
+                    buf = xmlStrdup(text->content);
+                buf = xmlStrcat(buf, cur->content);
+                if (buf == NULL) {
+                    xmlRngVErrMemory(ctxt);
+                    return (p);
+                }
+            }
+            cur = cur->next;
+            continue;
+        }
+        if ((cur != NULL) && (cur->type != XML_ELEMENT_NODE)) {
+            cur = cur->next;
+            continue;
+        }
+
+        if ((text != NULL) || ((cur == NULL) && (!hasElem))) {
+            value = (buf != NULL) ? buf :
+                    (text != NULL) ? text->content : BAD_CAST "";
+            if (!xmlRelaxNGIsBlank((xmlChar *) value)) {
+                q = xmlRelaxNGPatText(ctxt, p, value, elem);
+                if (q->type == XML_RELAXNG_PAT_NOT_ALLOWED) {
+                    if (hasElem)
+                        xmlRelaxNGShowValidError(ctxt,
+                                XML_RELAXNG_ERR_TEXTWRONG, elem, text,
+                                elem->name, NULL);
+                    else
+                        xmlRelaxNGShowValidError(ctxt,
+                                XML_RELAXNG_ERR_CONTENTVALID, elem, NULL,
+                                elem->name, NULL);
                 } else {
-                    /* add all the new results to res and reff the container */
-                    for (k = 0; k < ctxt->states->nbState; k++)
-                        xmlRelaxNGAddStates(ctxt, res,
-                                            ctxt->states->tabState[k]);
-                    xmlRelaxNGFreeStates(ctxt, ctxt->states);
-                    ctxt->states = NULL;
+                    p = q;
                 }
+            } else if (!hasElem) {
+                p = xmlRelaxNGPatChoice(ctxt, p,
+                        xmlRelaxNGPatText(ctxt, p, value, elem));
             }
-        } else {
-            if (ctxt->state != NULL) {
-                xmlRelaxNGFreeValidState(ctxt, ctxt->state);
-                ctxt->state = NULL;
-            } else if (ctxt->states != NULL) {
-                for (k = 0; k < ctxt->states->nbState; k++)
-                    xmlRelaxNGFreeValidState(ctxt,
-                                             ctxt->states->tabState[k]);
-                xmlRelaxNGFreeStates(ctxt, ctxt->states);
-                ctxt->states = NULL;
+            if (buf != NULL) {
+                xmlFree(buf);
+                buf = NULL;
             }
+            text = NULL;
         }
+        if (cur == NULL)
+            break;
+
+        p = xmlRelaxNGPatElement(ctxt, p, cur);
+        cur = cur->next;
     }
-    ctxt->flags = oldflags;
-    if (res != NULL) {
-        xmlRelaxNGFreeStates(ctxt, states);
-        ctxt->states = res;
-        ret = 0;
-    } else if (j > 1) {
-        states->nbState = j;
-        ctxt->states = states;
-        ret = 0;
-    } else if (j == 1) {
-        ctxt->state = states->tabState[0];
-        xmlRelaxNGFreeStates(ctxt, states);
-        ret = 0;
-    } else {
-        ret = -1;
-        xmlRelaxNGFreeStates(ctxt, states);
-        if (ctxt->states != NULL) {
-            xmlRelaxNGFreeStates(ctxt, ctxt->states);
-            ctxt->states = NULL;
-        }
+
+    return (p);
+}
+
+/**
+ * Derivative with respect to an element. Errors are reported and
+ * the returned pattern recovers from them.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param p  the pattern
+ * @param elem  the element
+ * @returns the derivative
+ */
+static xmlRelaxNGPatPtr
+xmlRelaxNGPatElement(xmlRelaxNGValidCtxtPtr ctxt, xmlRelaxNGPatPtr p,
+                     xmlNodePtr elem)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGPatPtr cur, q;
+    const xmlChar *name, *ns = NULL;
+    xmlAttrPtr attr;
+    xmlChar *value;
+
+    name = xmlDictLookup(deriv->dict, elem->name, -1);
+    if ((elem->ns != NULL) && (elem->ns->href != NULL))
+        ns = xmlDictLookup(deriv->dict, elem->ns->href, -1);
+    if ((name == NULL) || ((elem->ns != NULL) && (ns == NULL))) {
+        xmlRngVErrMemory(ctxt);
+        return (p);
+    }
+
+    cur = xmlRelaxNGPatStartOpen(ctxt, p, elem, name, ns);
+    if (cur->type == XML_RELAXNG_PAT_NOT_ALLOWED) {
+        /* Skip the element */
+        xmlRelaxNGShowValidError(ctxt, XML_RELAXNG_ERR_ELEMWRONG, elem,
+                                 NULL, elem->name, NULL);
+        return (p);
+    }
+
+    for (attr = elem->properties; attr != NULL; attr = attr->next) {
+        value = xmlNodeListGetString(elem->doc, attr->children, 1);
+        q = xmlRelaxNGPatAttr(ctxt, cur, attr,
+                              (value != NULL) ? value : BAD_CAST "");
+        if (value != NULL)
+            xmlFree(value);
+        if (q->type == XML_RELAXNG_PAT_NOT_ALLOWED)
+            xmlRelaxNGShowValidError(ctxt, XML_RELAXNG_ERR_INVALIDATTR,
+                                     elem, NULL, attr->name, elem->name);
+        else
+            cur = q;
     }
-    if ((ctxt->state != NULL) && (ctxt->states != NULL)) {
-        /* TODO */
-        xmlRelaxNGFreeValidState(ctxt, ctxt->state);
-        ctxt->state = NULL;
+
+    q = xmlRelaxNGPatStartClose(ctxt, cur, 0);
+    if (q->type == XML_RELAXNG_PAT_NOT_ALLOWED) {
+        xmlRelaxNGShowValidError(ctxt, XML_RELAXNG_ERR_ATTRVALID, elem,
+                                 NULL, elem->name, NULL);
+        q = xmlRelaxNGPatStartClose(ctxt, cur, 1);
     }
-    return (ret);
+    cur = xmlRelaxNGPatChildren(ctxt, q, elem);
+
+    q = xmlRelaxNGPatEnd(ctxt, cur, 0);
+    if (q->type == XML_RELAXNG_PAT_NOT_ALLOWED) {
+        xmlRelaxNGShowValidError(ctxt, XML_RELAXNG_ERR_CONTENTVALID, elem,
+                                 NULL, elem->name, NULL);
+        q = xmlRelaxNGPatEnd(ctxt, cur, 1);
+    }
+
+    return (q);
+}
+
+/**
+ * Validate a document with pattern derivatives.
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param doc  the document
+ * @returns 0 if the validation succeeded or an error code.
+ */
+static int
+xmlRelaxNGDerivValidateDocument(xmlRelaxNGValidCtxtPtr ctxt, xmlDocPtr doc)
+{
+    xmlRelaxNGDerivPtr deriv = ctxt->deriv;
+    xmlRelaxNGPatPtr p;
+    xmlNodePtr root;
+
+    if ((deriv != NULL) && (deriv->nbMemo > XML_RELAXNG_MAX_MEMO)) {
+        xmlRelaxNGFreeDeriv(deriv);
+        ctxt->deriv = deriv = NULL;
+    }
+    if (deriv == NULL) {
+        deriv = xmlMalloc(sizeof(*deriv));
+        if (deriv == NULL) {
+            xmlRngVErrMemory(ctxt);
+            return (-1);
+        }
+        memset(deriv, 0, sizeof(*deriv));
+        deriv->memoSize = 1024;
+        deriv->memo = xmlMalloc(deriv->memoSize * sizeof(deriv->memo[0]));
+        deriv->dict = xmlDictCreate();
+        ctxt->deriv = deriv;
+        if ((deriv->memo == NULL) || (deriv->dict == NULL)) {
+            xmlRngVErrMemory(ctxt);
+            xmlRelaxNGFreeDeriv(deriv);
+            ctxt->deriv = NULL;
+            return (-1);
+        }
+        memset(deriv->memo, 0, deriv->memoSize * sizeof(deriv->memo[0]));
+        /* NotAllowed is also returned on errors, so create it first */
+        deriv->notAllowed = xmlRelaxNGPatGet(ctxt,
+                XML_RELAXNG_PAT_NOT_ALLOWED, NULL, NULL, NULL);
+        deriv->empty = xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_EMPTY,
+                                        NULL, NULL, NULL);
+        deriv->text = xmlRelaxNGPatGet(ctxt, XML_RELAXNG_PAT_TEXT,
+                                       NULL, NULL, NULL);
+        if ((deriv->notAllowed == NULL) ||
+            (deriv->notAllowed->type != XML_RELAXNG_PAT_NOT_ALLOWED) ||
+            (deriv->empty->type != XML_RELAXNG_PAT_EMPTY) ||
+            (deriv->text->type != XML_RELAXNG_PAT_TEXT)) {
+            xmlRelaxNGFreeDeriv(deriv);
+            ctxt->deriv = NULL;
+            return (-1);
+        }
+    }
+
+    root = xmlDocGetRootElement(doc);
+    if (root == NULL)
+        return (-1);
+    p = xmlRelaxNGPatConvert(ctxt, ctxt->schema->topgrammar->start);
+    p = xmlRelaxNGPatElement(ctxt, p, root);
+    if ((!p->nullable) && (ctxt->errNo == XML_RELAXNG_OK))
+        xmlRelaxNGShowValidError(ctxt, XML_RELAXNG_ERR_EXTRADATA,
+                                 (xmlNodePtr) doc, NULL, NULL, NULL);
+
+    return ((ctxt->errNo == XML_RELAXNG_OK) ? 0 : -1);
 }
 
 /**
@@ -10409,6 +13111,10 @@ xmlRelaxNGValidateDocument(xmlRelaxNGValidCtxtPtr ctxt, xmlDocPtr doc)
         VALID_ERR(XML_RELAXNG_ERR_NOGRAMMAR);
         return (-1);
     }
+    if (ctxt->derivatives) {
+        ret = xmlRelaxNGDerivValidateDocument(ctxt, doc);
+        goto done;
+    }
     state = xmlRelaxNGNewValidState(ctxt, NULL);
     ctxt->state = state;
     ret = xmlRelaxNGValidateDefinition(ctxt, grammar->start);
@@ -10447,6 +13153,7 @@ xmlRelaxNGValidateDocument(xmlRelaxNGValidCtxtPtr ctxt, xmlDocPtr doc)
     }
     if (ret != 0)
         xmlRelaxNGDumpValidError(ctxt);
+done:
 #ifdef LIBXML_VALID_ENABLED
     if (ctxt->idref == 1) {
         xmlValidCtxt vctxt;
@@ -10559,6 +13266,8 @@ xmlRelaxNGNewValidCtxt(xmlRelaxNG *schema)
     ret->freeState = NULL;
     ret->freeStates = NULL;
     ret->errNo = XML_RELAXNG_OK;
+    /* The pool is optional, validation works without it */
+    ret->execPool = xmlRegExecPoolCreate();
     return (ret);
 }
 
@@ -10600,6 +13309,10 @@ xmlRelaxNGFreeValidCtxt(xmlRelaxNGValidCtxt *ctxt)
         }
         xmlFree(ctxt->elemTab);
     }
+    xmlRelaxNGFreeDeriv(ctxt->deriv);
+    xmlErrorPolicyFree(ctxt->errorPolicy);
+    xmlRegExecPoolFree(ctxt->execPool);
+    xmlFree(ctxt->pvalue);
     xmlFree(ctxt);
 }
 
@@ -10645,6 +13358,75 @@ xmlRelaxNGSetValidStructuredErrors(xmlRelaxNGValidCtxt *ctxt,
     ctxt->userData = ctx;
 }
 
+/**
+ * Validate documents by computing derivatives of the schema
+ * patterns instead of backtracking over validation states. This
+ * avoids exponential behavior with large interleaves and choices,
+ * but error messages can differ. Only #xmlRelaxNGValidateDoc is
+ * affected, not the push interfaces.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param derivatives  whether to use pattern derivatives
+ * @returns 0 on success or -1 if `ctxt` is NULL.
+ */
+int
+xmlRelaxNGSetValidDerivatives(xmlRelaxNGValidCtxt *ctxt, int derivatives)
+{
+    if (ctxt == NULL)
+        return (-1);
+    ctxt->derivatives = (derivatives != 0);
+    return (0);
+}
+
+/**
+ * Limit the errors reported by a validation context. Works like
+ * #xmlCtxtSetErrorPolicy. Once `maxErrors` errors were raised, no
+ * more errors are reported but validation continues. Counts are
+ * reset by #xmlRelaxNGValidateDoc.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param maxErrors  maximum number of errors or 0 for no limit
+ * @param maxPerCode  maximum number of errors per code or 0 for no limit
+ * @param dedup  whether to report each code once per node type
+ * @returns 0 on success or -1 if an argument was invalid or a memory
+ * allocation failed.
+ */
+int
+xmlRelaxNGSetValidErrorPolicy(xmlRelaxNGValidCtxt *ctxt, int maxErrors,
+                              int maxPerCode, int dedup)
+{
+    if (ctxt == NULL)
+        return (-1);
+    return (xmlErrorPolicySet(&ctxt->errorPolicy, maxErrors, maxPerCode,
+                              dedup));
+}
+
+/**
+ * Get the number of errors with a code raised since the last
+ * validation run started, including errors which weren't reported
+ * because of the error policy. Only works if an error policy was
+ * set with #xmlRelaxNGSetValidErrorPolicy.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a Relax-NG validation context
+ * @param code  the error code
+ * @param nodeType  node type, 0 for errors without node or -1 for all
+ * @returns the number of errors.
+ */
+int
+xmlRelaxNGValidGetErrorCount(xmlRelaxNGValidCtxt *ctxt, int code,
+                             int nodeType)
+{
+    if (ctxt == NULL)
+        return (0);
+    return (xmlErrorPolicyCount(ctxt->errorPolicy, code, nodeType));
+}
+
 /**
  * Get the error and warning callback information
  *
@@ -10683,10 +13465,15 @@ xmlRelaxNGValidateDoc(xmlRelaxNGValidCtxt *ctxt, xmlDoc *doc)
 {
     int ret;
 
+    double start;
+
     if ((ctxt == NULL) || (doc == NULL))
         return (-1);
 
+    XML_TRACE_BEGIN(valid, XML_TRACE_VALID_START, "relaxng", start);
+
     ctxt->doc = doc;
+    xmlErrorPolicyReset(ctxt->errorPolicy);
 
     ret = xmlRelaxNGValidateDocument(ctxt, doc);
     /*
@@ -10694,6 +13481,8 @@ xmlRelaxNGValidateDoc(xmlRelaxNGValidCtxt *ctxt, xmlDoc *doc)
      */
     xmlRelaxNGCleanPSVI((xmlNodePtr) doc);
 
+    XML_TRACE_END(valid, XML_TRACE_VALID_END, "relaxng", -1L, start);
+
     /*
      * TODO: build error codes
      */
@@ -0,0 +1,859 @@
+/*
+ * runbench.c: C program to run libxml2 performance benchmarks
+ *
+ * Runs microbenchmarks of individual components and macro benchmarks
+ * of the SAX, DOM, reader and push parsers on generated documents.
+ * The generated corpora are deterministic so numbers from different
+ * builds can be compared directly.
+ *
+ * Usage: runbench [-l] [-t ms] [-n samples] [-s kbytes] [pattern...]
+ *
+ * See Copyright for the status of this software.
+ */
+
+#include "libxml.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/dict.h>
+#include <libxml/hash.h>
+#include <libxml/encoding.h>
+#ifdef LIBXML_READER_ENABLED
+#include <libxml/xmlreader.h>
+#endif
+#ifdef LIBXML_XPATH_ENABLED
+#include <libxml/xpath.h>
+#endif
+#ifdef LIBXML_REGEXP_ENABLED
+#include <libxml/xmlregexp.h>
+#endif
+#ifdef LIBXML_SCHEMAS_ENABLED
+#include <libxml/xmlschemastypes.h>
+#endif
+#ifdef LIBXML_OUTPUT_ENABLED
+#include <libxml/xmlsave.h>
+#endif
+
+static double sampleTime = 0.1; /* seconds per sample */
+static int numSamples = 5;
+static size_t corpusSize = 1024 * 1024;
+
+/************************************************************************
+ *									*
+ *		Timing							*
+ *									*
+ ************************************************************************/
+
+static double
+benchNow(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return((double) count.QuadPart / (double) freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((double) ts.tv_sec + (double) ts.tv_nsec / 1e9);
+#else
+    return((double) clock() / CLOCKS_PER_SEC);
+#endif
+}
+
+/************************************************************************
+ *									*
+ *		Corpus generation					*
+ *									*
+ ************************************************************************/
+
+typedef struct {
+    const char *name;
+    char *data;
+    int size;
+} benchCorpus;
+
+enum {
+    CORPUS_DATA = 0,
+    CORPUS_DOCUMENT,
+    CORPUS_ATTRIBUTES,
+    CORPUS_NAMESPACES,
+    CORPUS_CHARDATA,
+    CORPUS_MAX
+};
+
+static benchCorpus corpora[CORPUS_MAX] = {
+    { "data", NULL, 0 },
+    { "document", NULL, 0 },
+    { "attributes", NULL, 0 },
+    { "namespaces", NULL, 0 },
+    { "chardata", NULL, 0 }
+};
+
+static const char *const words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing",
+    "elit", "sed", "do", "eiusmod", "tempor", "incididunt", "ut", "labore",
+    "et", "dolore", "magna", "aliqua", "enim", "ad", "minim", "veniam",
+    "caf\xC3\xA9", "na\xC3\xAFve"
+};
+
+#define NUM_WORDS (sizeof(words) / sizeof(words[0]))
+
+/*
+ * Small deterministic PRNG so that corpora are identical across runs
+ * and platforms.
+ */
+static unsigned
+benchRand(unsigned *state) {
+    *state = *state * 1103515245u + 12345u;
+    return((*state >> 16) & 0x7FFF);
+}
+
+static void
+genPrintf(xmlBufferPtr buf, const char *fmt, ...) LIBXML_ATTR_FORMAT(2,3);
+
+static void
+genPrintf(xmlBufferPtr buf, const char *fmt, ...) {
+    char tmp[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    xmlBufferCCat(buf, tmp);
+}
+
+static void
+genWords(xmlBufferPtr buf, unsigned *seed, int n) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (i > 0)
+            xmlBufferCCat(buf, " ");
+        xmlBufferCCat(buf, words[benchRand(seed) % NUM_WORDS]);
+    }
+}
+
+/* Records with short typed fields, typical of data exchange formats */
+static void
+genData(xmlBufferPtr buf, unsigned *seed, int i) {
+    genPrintf(buf,
+              "  <record id=\"r%d\">\n"
+              "    <name>", i);
+    genWords(buf, seed, 2);
+    genPrintf(buf,
+              "</name>\n"
+              "    <price>%u.%02u</price>\n"
+              "    <quantity>%u</quantity>\n"
+              "    <date>2024-%02u-%02uT12:00:00Z</date>\n"
+              "    <active>%s</active>\n"
+              "  </record>\n",
+              benchRand(seed) % 1000, benchRand(seed) % 100,
+              benchRand(seed) % 50, benchRand(seed) % 12 + 1,
+              benchRand(seed) % 28 + 1,
+              (benchRand(seed) & 1) ? "true" : "false");
+}
+
+/* Prose with mixed content, entities and character references */
+static void
+genDocument(xmlBufferPtr buf, unsigned *seed, int i) {
+    int j;
+
+    genPrintf(buf, "  <section id=\"s%d\">\n    <title>", i);
+    genWords(buf, seed, 4);
+    xmlBufferCCat(buf, "</title>\n");
+    for (j = 0; j < 3; j++) {
+        xmlBufferCCat(buf, "    <p>");
+        genWords(buf, seed, 12);
+        xmlBufferCCat(buf, " <em>");
+        genWords(buf, seed, 2);
+        xmlBufferCCat(buf, "</em> &amp; ");
+        genWords(buf, seed, 8);
+        genPrintf(buf, " <a href=\"#s%u\">", benchRand(seed) % (i + 1));
+        genWords(buf, seed, 3);
+        xmlBufferCCat(buf, "</a> &#233;t&#xE9; ");
+        genWords(buf, seed, 10);
+        xmlBufferCCat(buf, ".</p>\n");
+    }
+    xmlBufferCCat(buf, "  </section>\n");
+}
+
+/* Empty elements carrying many attributes */
+static void
+genAttributes(xmlBufferPtr buf, unsigned *seed, int i) {
+    int j;
+
+    genPrintf(buf, "  <item id=\"i%d\"", i);
+    for (j = 0; j < 12; j++) {
+        genPrintf(buf, " attr%d=\"%s %u\"", j,
+                  words[benchRand(seed) % NUM_WORDS], benchRand(seed));
+    }
+    xmlBufferCCat(buf, " note=\"a &lt; b &amp;&amp; c\"/>\n");
+}
+
+/* Prefixed elements and attributes with local redeclarations */
+static void
+genNamespaces(xmlBufferPtr buf, unsigned *seed, int i) {
+    genPrintf(buf,
+              "  <a:entry xmlns:c=\"urn:example:c%d\" b:ref=\"%u\">\n"
+              "    <b:key a:type=\"string\">", i % 8, benchRand(seed));
+    genWords(buf, seed, 2);
+    genPrintf(buf,
+              "</b:key>\n"
+              "    <c:value xmlns=\"urn:example:v\" c:unit=\"m\">"
+              "<v>%u</v></c:value>\n"
+              "    <link xmlns:d=\"urn:example:d\" d:href=\"#e%u\"/>\n"
+              "  </a:entry>\n",
+              benchRand(seed), benchRand(seed) % (i + 1));
+}
+
+/* Long runs of character data with few tags */
+static void
+genCharData(xmlBufferPtr buf, unsigned *seed, int i ATTRIBUTE_UNUSED) {
+    xmlBufferCCat(buf, "  <text>");
+    genWords(buf, seed, 400);
+    xmlBufferCCat(buf, "</text>\n");
+}
+
+static int
+genCorpus(int which) {
+    static const char *const heads[CORPUS_MAX] = {
+        "<records>\n",
+        "<article>\n",
+        "<items>\n",
+        "<root xmlns=\"urn:example:default\" xmlns:a=\"urn:example:a\""
+            " xmlns:b=\"urn:example:b\">\n",
+        "<texts>\n"
+    };
+    static const char *const tails[CORPUS_MAX] = {
+        "</records>\n",
+        "</article>\n",
+        "</items>\n",
+        "</root>\n",
+        "</texts>\n"
+    };
+    xmlBufferPtr buf;
+    unsigned seed = 42 + which;
+    int i;
+
+    buf = xmlBufferCreate();
+    if (buf == NULL)
+        return(-1);
+    xmlBufferCCat(buf, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    xmlBufferCCat(buf, heads[which]);
+    for (i = 0; (size_t) xmlBufferLength(buf) < corpusSize; i++) {
+        switch (which) {
+            case CORPUS_DATA: genData(buf, &seed, i); break;
+            case CORPUS_DOCUMENT: genDocument(buf, &seed, i); break;
+            case CORPUS_ATTRIBUTES: genAttributes(buf, &seed, i); break;
+            case CORPUS_NAMESPACES: genNamespaces(buf, &seed, i); break;
+            default: genCharData(buf, &seed, i); break;
+        }
+    }
+    xmlBufferCCat(buf, tails[which]);
+
+    corpora[which].size = xmlBufferLength(buf);
+    corpora[which].data = (char *) xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+
+    return(corpora[which].data == NULL ? -1 : 0);
+}
+
+/************************************************************************
+ *									*
+ *		Shared state for microbenchmarks			*
+ *									*
+ ************************************************************************/
+
+#define NUM_NAMES 1000
+
+static xmlChar *names[NUM_NAMES];
+static xmlDictPtr dict;
+static xmlHashTablePtr hash;
+static xmlDocPtr dataDoc;
+static xmlDocPtr docDoc;
+static const char *const encodings[] = { "ISO-8859-1", "UTF-16LE" };
+static xmlCharEncodingHandlerPtr encHandlers[2][2];
+static xmlBufferPtr encInputs[2];
+static xmlBufferPtr encOut;
+#ifdef LIBXML_XPATH_ENABLED
+static xmlXPathContextPtr xpathCtxt;
+#endif
+#ifdef LIBXML_REGEXP_ENABLED
+static xmlRegexpPtr regexp;
+#endif
+
+static int
+benchInit(void) {
+    char tmp[50];
+    int i;
+
+    for (i = 0; i < CORPUS_MAX; i++) {
+        if (genCorpus(i) < 0)
+            return(-1);
+    }
+
+    dict = xmlDictCreate();
+    hash = xmlHashCreate(0);
+    if ((dict == NULL) || (hash == NULL))
+        return(-1);
+    for (i = 0; i < NUM_NAMES; i++) {
+        snprintf(tmp, sizeof(tmp), "%s-%s%d", words[i % NUM_WORDS],
+                 words[(i * 7) % NUM_WORDS], i);
+        names[i] = xmlStrdup(BAD_CAST tmp);
+        if ((names[i] == NULL) ||
+            (xmlDictLookup(dict, names[i], -1) == NULL) ||
+            (xmlHashAddEntry(hash, names[i], names[i]) < 0))
+            return(-1);
+    }
+
+    dataDoc = xmlReadMemory(corpora[CORPUS_DATA].data,
+                            corpora[CORPUS_DATA].size, NULL, NULL, 0);
+    docDoc = xmlReadMemory(corpora[CORPUS_DOCUMENT].data,
+                           corpora[CORPUS_DOCUMENT].size, NULL, NULL, 0);
+    if ((dataDoc == NULL) || (docDoc == NULL))
+        return(-1);
+
+    /* Convert the char data corpus once to get input for decoders */
+    encOut = xmlBufferCreate();
+    if (encOut == NULL)
+        return(-1);
+    for (i = 0; i < 2; i++) {
+        xmlBufferPtr in;
+
+        if ((xmlOpenCharEncodingHandler(encodings[i], 0,
+                                        &encHandlers[i][0]) != 0) ||
+            (xmlOpenCharEncodingHandler(encodings[i], 1,
+                                        &encHandlers[i][1]) != 0))
+            return(-1);
+        encInputs[i] = xmlBufferCreate();
+        in = xmlBufferCreateStatic(corpora[CORPUS_CHARDATA].data,
+                                   corpora[CORPUS_CHARDATA].size);
+        if ((encInputs[i] == NULL) || (in == NULL) ||
+            (xmlCharEncOutFunc(encHandlers[i][1], encInputs[i], in) < 0)) {
+            xmlBufferFree(in);
+            return(-1);
+        }
+        xmlBufferFree(in);
+    }
+
+#ifdef LIBXML_XPATH_ENABLED
+    xpathCtxt = xmlXPathNewContext(dataDoc);
+    if (xpathCtxt == NULL)
+        return(-1);
+#endif
+#ifdef LIBXML_REGEXP_ENABLED
+    regexp = xmlRegexpCompile(BAD_CAST "([a-z]+-)?[a-z]+[0-9]*");
+    if (regexp == NULL)
+        return(-1);
+#endif
+#ifdef LIBXML_SCHEMAS_ENABLED
+    if (xmlSchemaInitTypes() < 0)
+        return(-1);
+#endif
+
+    return(0);
+}
+
+static void
+benchCleanup(void) {
+    int i;
+
+#ifdef LIBXML_REGEXP_ENABLED
+    xmlRegFreeRegexp(regexp);
+#endif
+#ifdef LIBXML_XPATH_ENABLED
+    xmlXPathFreeContext(xpathCtxt);
+#endif
+    for (i = 0; i < 2; i++) {
+        xmlCharEncCloseFunc(encHandlers[i][0]);
+        xmlCharEncCloseFunc(encHandlers[i][1]);
+        xmlBufferFree(encInputs[i]);
+    }
+    xmlBufferFree(encOut);
+    xmlFreeDoc(dataDoc);
+    xmlFreeDoc(docDoc);
+    xmlHashFree(hash, NULL);
+    xmlDictFree(dict);
+    for (i = 0; i < NUM_NAMES; i++)
+        xmlFree(names[i]);
+    for (i = 0; i < CORPUS_MAX; i++)
+        xmlFree(corpora[i].data);
+}
+
+/************************************************************************
+ *									*
+ *		Microbenchmarks						*
+ *									*
+ * Each function performs one operation and returns the number of	*
+ * input bytes processed, or 0 if throughput isn't meaningful.		*
+ *									*
+ ************************************************************************/
+
+static size_t
+benchDictLookup(int arg ATTRIBUTE_UNUSED) {
+    int i;
+
+    for (i = 0; i < NUM_NAMES; i++)
+        xmlDictLookup(dict, names[i], -1);
+
+    return(0);
+}
+
+static size_t
+benchHashLookup(int arg ATTRIBUTE_UNUSED) {
+    int i;
+
+    for (i = 0; i < NUM_NAMES; i++)
+        xmlHashLookup(hash, names[i]);
+
+    return(0);
+}
+
+/*
+ * Parse one of the corpora to a tree, used for the char data and
+ * attribute parsing microbenchmarks.
+ */
+static size_t
+benchParseCorpus(int arg) {
+    xmlDocPtr doc;
+
+    doc = xmlReadMemory(corpora[arg].data, corpora[arg].size, NULL, NULL, 0);
+    xmlFreeDoc(doc);
+
+    return(corpora[arg].size);
+}
+
+static size_t
+benchEncodingIn(int arg) {
+    xmlBufferPtr in;
+    int len = xmlBufferLength(encInputs[arg]);
+
+    in = xmlBufferCreateStatic((void *) xmlBufferContent(encInputs[arg]),
+                               len);
+    xmlBufferEmpty(encOut);
+    xmlCharEncInFunc(encHandlers[arg][0], encOut, in);
+    xmlBufferFree(in);
+
+    return(len);
+}
+
+static size_t
+benchEncodingOut(int arg) {
+    xmlBufferPtr in;
+    int len = corpora[CORPUS_CHARDATA].size;
+
+    in = xmlBufferCreateStatic(corpora[CORPUS_CHARDATA].data, len);
+    xmlBufferEmpty(encOut);
+    xmlCharEncOutFunc(encHandlers[arg][1], encOut, in);
+    xmlBufferFree(in);
+
+    return(len);
+}
+
+#ifdef LIBXML_XPATH_ENABLED
+static const char *const xpathExprs[] = {
+    "/records/record/name",
+    "//price",
+    "count(//record[@id])",
+    "//record[quantity > 25]/name",
+    "sum(/records/record/price)"
+};
+
+static size_t
+benchXPath(int arg) {
+    xmlXPathObjectPtr res;
+
+    res = xmlXPathEvalExpression(BAD_CAST xpathExprs[arg], xpathCtxt);
+    xmlXPathFreeObject(res);
+
+    return(0);
+}
+#endif
+
+#ifdef LIBXML_REGEXP_ENABLED
+static size_t
+benchRegexp(int arg ATTRIBUTE_UNUSED) {
+    size_t bytes = 0;
+    int i;
+
+    for (i = 0; i < NUM_NAMES; i++) {
+        xmlRegexpExec(regexp, names[i]);
+        bytes += xmlStrlen(names[i]);
+    }
+
+    return(bytes);
+}
+#endif
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+static const struct {
+    xmlSchemaValType type;
+    const char *values[4];
+} schemaValues[] = {
+    { XML_SCHEMAS_DECIMAL, { "123.456", "-0.5", "+1000000", "3.14159265" } },
+    { XML_SCHEMAS_INT, { "42", "-2147483648", "2147483647", "  7  " } },
+    { XML_SCHEMAS_DATETIME, { "2024-01-02T12:00:00Z",
+                              "1999-12-31T23:59:59.999+05:30",
+                              "2000-02-29T00:00:00", "2024-06-15T08:30:00-08:00" } },
+    { XML_SCHEMAS_ANYURI, { "http://example.org/a/b?c=d#e", "urn:example:x",
+                            "../relative/path", "mailto:user@example.org" } },
+    { XML_SCHEMAS_QNAME, { "xs:string", "local", "a:b", "ns1:element" } }
+};
+
+static size_t
+benchSchemaType(int arg) {
+    xmlSchemaTypePtr type;
+    xmlSchemaValPtr val;
+    int i;
+
+    type = xmlSchemaGetBuiltInType(schemaValues[arg].type);
+    for (i = 0; i < 4; i++) {
+        val = NULL;
+        /* QNames need a node for namespace lookup */
+        if (schemaValues[arg].type == XML_SCHEMAS_QNAME)
+            xmlSchemaValPredefTypeNode(type,
+                    BAD_CAST schemaValues[arg].values[i], &val,
+                    xmlDocGetRootElement(dataDoc));
+        else
+            xmlSchemaValidatePredefinedType(type,
+                    BAD_CAST schemaValues[arg].values[i], &val);
+        if (val != NULL)
+            xmlSchemaFreeValue(val);
+    }
+
+    return(0);
+}
+#endif
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static size_t
+benchSave(int arg) {
+    xmlBufferPtr buf;
+    xmlSaveCtxtPtr save;
+    size_t len;
+
+    buf = xmlBufferCreate();
+    save = xmlSaveToBuffer(buf, NULL, arg ? XML_SAVE_FORMAT : 0);
+    xmlSaveDoc(save, docDoc);
+    xmlSaveClose(save);
+    len = xmlBufferLength(buf);
+    xmlBufferFree(buf);
+
+    return(len);
+}
+#endif
+
+/************************************************************************
+ *									*
+ *		Macro benchmarks					*
+ *									*
+ ************************************************************************/
+
+static unsigned long saxEvents;
+
+static void
+saxStartElementNs(void *ctx ATTRIBUTE_UNUSED,
+                  const xmlChar *localname ATTRIBUTE_UNUSED,
+                  const xmlChar *prefix ATTRIBUTE_UNUSED,
+                  const xmlChar *URI ATTRIBUTE_UNUSED,
+                  int nb_namespaces ATTRIBUTE_UNUSED,
+                  const xmlChar **namespaces ATTRIBUTE_UNUSED,
+                  int nb_attributes ATTRIBUTE_UNUSED,
+                  int nb_defaulted ATTRIBUTE_UNUSED,
+                  const xmlChar **attributes ATTRIBUTE_UNUSED) {
+    saxEvents++;
+}
+
+static void
+saxEndElementNs(void *ctx ATTRIBUTE_UNUSED,
+                const xmlChar *localname ATTRIBUTE_UNUSED,
+                const xmlChar *prefix ATTRIBUTE_UNUSED,
+                const xmlChar *URI ATTRIBUTE_UNUSED) {
+    saxEvents++;
+}
+
+static void
+saxCharacters(void *ctx ATTRIBUTE_UNUSED, const xmlChar *ch ATTRIBUTE_UNUSED,
+              int len ATTRIBUTE_UNUSED) {
+    saxEvents++;
+}
+
+static size_t
+benchSAX(int arg) {
+    xmlSAXHandler sax;
+    xmlParserCtxtPtr ctxt;
+
+    memset(&sax, 0, sizeof(sax));
+    sax.initialized = XML_SAX2_MAGIC;
+    sax.startElementNs = saxStartElementNs;
+    sax.endElementNs = saxEndElementNs;
+    sax.characters = saxCharacters;
+
+    ctxt = xmlNewSAXParserCtxt(&sax, NULL);
+    if (ctxt == NULL)
+        return(0);
+    xmlCtxtReadMemory(ctxt, corpora[arg].data, corpora[arg].size,
+                      NULL, NULL, 0);
+    xmlFreeParserCtxt(ctxt);
+
+    return(corpora[arg].size);
+}
+
+static size_t
+benchDOM(int arg) {
+    return(benchParseCorpus(arg));
+}
+
+#ifdef LIBXML_READER_ENABLED
+static size_t
+benchReader(int arg) {
+    xmlTextReaderPtr reader;
+
+    reader = xmlReaderForMemory(corpora[arg].data, corpora[arg].size,
+                                NULL, NULL, 0);
+    if (reader == NULL)
+        return(0);
+    while (xmlTextReaderRead(reader) == 1)
+        ;
+    xmlFreeTextReader(reader);
+
+    return(corpora[arg].size);
+}
+#endif
+
+#ifdef LIBXML_PUSH_ENABLED
+#define PUSH_CHUNK_SIZE 4096
+
+static size_t
+benchPush(int arg) {
+    xmlParserCtxtPtr ctxt;
+    const char *data = corpora[arg].data;
+    int size = corpora[arg].size;
+    int i, len;
+
+    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+    if (ctxt == NULL)
+        return(0);
+    for (i = 0; i < size; i += len) {
+        len = size - i;
+        if (len > PUSH_CHUNK_SIZE)
+            len = PUSH_CHUNK_SIZE;
+        xmlParseChunk(ctxt, data + i, len, 0);
+    }
+    xmlParseChunk(ctxt, NULL, 0, 1);
+    xmlFreeDoc(ctxt->myDoc);
+    xmlFreeParserCtxt(ctxt);
+
+    return(size);
+}
+#endif
+
+/************************************************************************
+ *									*
+ *		Benchmark table and runner				*
+ *									*
+ ************************************************************************/
+
+typedef size_t (*benchFunc)(int arg);
+
+typedef struct {
+    const char *name;
+    benchFunc func;
+    int arg;
+} benchDesc;
+
+#define MACRO_BENCH(kind, func) \
+    { kind "/data", func, CORPUS_DATA }, \
+    { kind "/document", func, CORPUS_DOCUMENT }, \
+    { kind "/attributes", func, CORPUS_ATTRIBUTES }, \
+    { kind "/namespaces", func, CORPUS_NAMESPACES }
+
+static const benchDesc benchmarks[] = {
+    { "dict/lookup", benchDictLookup, 0 },
+    { "hash/lookup", benchHashLookup, 0 },
+    { "parse/chardata", benchParseCorpus, CORPUS_CHARDATA },
+    { "parse/attributes", benchParseCorpus, CORPUS_ATTRIBUTES },
+    { "encoding/latin1-in", benchEncodingIn, 0 },
+    { "encoding/utf16-in", benchEncodingIn, 1 },
+    { "encoding/latin1-out", benchEncodingOut, 0 },
+    { "encoding/utf16-out", benchEncodingOut, 1 },
+#ifdef LIBXML_XPATH_ENABLED
+    { "xpath/child-steps", benchXPath, 0 },
+    { "xpath/descendant", benchXPath, 1 },
+    { "xpath/count", benchXPath, 2 },
+    { "xpath/predicate", benchXPath, 3 },
+    { "xpath/sum", benchXPath, 4 },
+#endif
+#ifdef LIBXML_REGEXP_ENABLED
+    { "regexp/exec", benchRegexp, 0 },
+#endif
+#ifdef LIBXML_SCHEMAS_ENABLED
+    { "xsd/decimal", benchSchemaType, 0 },
+    { "xsd/int", benchSchemaType, 1 },
+    { "xsd/dateTime", benchSchemaType, 2 },
+    { "xsd/anyURI", benchSchemaType, 3 },
+    { "xsd/QName", benchSchemaType, 4 },
+#endif
+#ifdef LIBXML_OUTPUT_ENABLED
+    { "save/plain", benchSave, 0 },
+    { "save/format", benchSave, 1 },
+#endif
+    MACRO_BENCH("sax", benchSAX),
+    MACRO_BENCH("dom", benchDOM),
+#ifdef LIBXML_READER_ENABLED
+    MACRO_BENCH("reader", benchReader),
+#endif
+#ifdef LIBXML_PUSH_ENABLED
+    MACRO_BENCH("push", benchPush),
+#endif
+    { NULL, NULL, 0 }
+};
+
+static int
+compareDouble(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return((x > y) - (x < y));
+}
+
+static void
+runBench(const benchDesc *desc) {
+    double samples[100];
+    double start, elapsed;
+    size_t bytes = 0;
+    long ops, i;
+    int s;
+
+    /* Calibrate the number of operations per sample */
+    for (ops = 1; ; ops *= 2) {
+        start = benchNow();
+        for (i = 0; i < ops; i++)
+            bytes = desc->func(desc->arg);
+        elapsed = benchNow() - start;
+        if ((elapsed >= sampleTime / 4) || (ops >= (1L << 24)))
+            break;
+    }
+    if (elapsed > 0)
+        ops = (long) (ops * sampleTime / elapsed);
+    if (ops < 1)
+        ops = 1;
+
+    for (s = 0; s < numSamples; s++) {
+        start = benchNow();
+        for (i = 0; i < ops; i++)
+            desc->func(desc->arg);
+        samples[s] = (benchNow() - start) * 1e9 / ops;
+    }
+    qsort(samples, numSamples, sizeof(samples[0]), compareDouble);
+
+    printf("%-22s %14.1f ns/op %14.1f min", desc->name,
+           samples[numSamples / 2], samples[0]);
+    if (bytes > 0)
+        printf(" %10.2f MB/s", bytes * 1e3 / samples[numSamples / 2]);
+    printf("\n");
+    fflush(stdout);
+}
+
+static int
+matches(const char *name, int npatterns, char **patterns) {
+    int i;
+
+    if (npatterns == 0)
+        return(1);
+    for (i = 0; i < npatterns; i++) {
+        if (strstr(name, patterns[i]) != NULL)
+            return(1);
+    }
+
+    return(0);
+}
+
+static void
+usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-l] [-t ms] [-n samples] [-s kbytes] [pattern...]\n"
+            "\t-l : list benchmarks\n"
+            "\t-t ms : time per sample (default 100)\n"
+            "\t-n samples : number of samples, median is reported"
+            " (default 5)\n"
+            "\t-s kbytes : size of generated documents (default 1024)\n"
+            "\tpattern : only run benchmarks whose name contains pattern\n",
+            name);
+}
+
+int
+main(int argc, char **argv) {
+    char *patterns[50];
+    int npatterns = 0;
+    int list = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-l")) {
+            list = 1;
+        } else if ((!strcmp(argv[i], "-t")) && (i + 1 < argc)) {
+            sampleTime = atoi(argv[++i]) / 1000.0;
+            if (sampleTime <= 0) {
+                usage(argv[0]);
+                return(1);
+            }
+        } else if ((!strcmp(argv[i], "-n")) && (i + 1 < argc)) {
+            numSamples = atoi(argv[++i]);
+            if ((numSamples < 1) || (numSamples > 100)) {
+                usage(argv[0]);
+                return(1);
+            }
+        } else if ((!strcmp(argv[i], "-s")) && (i + 1 < argc)) {
+            int kb = atoi(argv[++i]);
+
+            if ((kb < 1) || (kb > 1024 * 1024)) {
+                usage(argv[0]);
+                return(1);
+            }
+            corpusSize = (size_t) kb * 1024;
+        } else if ((argv[i][0] != '-') &&
+                   (npatterns < (int) (sizeof(patterns) / sizeof(patterns[0])))) {
+            patterns[npatterns++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return(1);
+        }
+    }
+
+    if (list) {
+        for (i = 0; benchmarks[i].name != NULL; i++)
+            printf("%s\n", benchmarks[i].name);
+        return(0);
+    }
+
+    if (benchInit() < 0) {
+        fprintf(stderr, "Failed to set up benchmarks\n");
+        benchCleanup();
+        return(1);
+    }
+
+    for (i = 0; i < CORPUS_MAX; i++)
+        printf("corpus %-12s %10d bytes\n", corpora[i].name, corpora[i].size);
+    for (i = 0; benchmarks[i].name != NULL; i++) {
+        if (matches(benchmarks[i].name, npatterns, patterns))
+            runBench(&benchmarks[i]);
+    }
+
+    benchCleanup();
+    xmlCleanupParser();
+
+    return(0);
+}
@@ -4326,6 +4326,55 @@ parse_list(xmlChar *str) {
     return buffer;
 }
 
+static int
+c14nDigestAppend(void *ctxt, const unsigned char *data, int len) {
+    return(xmlBufferAdd((xmlBufferPtr) ctxt, data, len) == 0 ? 0 : -1);
+}
+
+#ifdef LIBXML_READER_ENABLED
+/*
+ * Canonicalize the whole document through a reader, without a tree
+ */
+static int
+c14nRunReaderTest(const char* xml_filename, int with_comments, int mode,
+                  xmlChar **inclusive_namespaces, const char* result_file) {
+    xmlTextReaderPtr reader;
+    xmlOutputBufferPtr buf;
+    int ret;
+
+    reader = xmlReaderForFile(xml_filename, NULL,
+            XML_PARSE_DTDATTR | XML_PARSE_NOENT | XML_PARSE_NOWARNING);
+    if (reader == NULL) {
+	fprintf(stderr, "Error: unable to open file \"%s\"\n", xml_filename);
+	return(-1);
+    }
+    buf = xmlAllocOutputBuffer(NULL);
+    if (buf == NULL) {
+        xmlFreeTextReader(reader);
+        return(-1);
+    }
+
+    ret = xmlC14NReaderSaveTo(reader, mode, inclusive_namespaces,
+                              with_comments, buf);
+    if (ret >= 0) {
+        if (compareFileMem(result_file,
+                           (const char *) xmlOutputBufferGetContent(buf),
+                           xmlOutputBufferGetSize(buf))) {
+            fprintf(stderr, "Reader result mismatch for %s\n", xml_filename);
+            fprintf(stderr, "RESULT:\n%s\n",
+                    (const char *) xmlOutputBufferGetContent(buf));
+            ret = -1;
+        }
+    } else {
+	fprintf(stderr,"Error: failed to canonicalize XML file \"%s\" from a reader\n", xml_filename);
+    }
+
+    xmlOutputBufferClose(buf);
+    xmlFreeTextReader(reader);
+    return(ret);
+}
+#endif
+
 static int
 c14nRunTest(const char* xml_filename, int with_comments, int mode,
 	    const char* xpath_filename, const char *ns_filename,
@@ -4402,6 +4451,29 @@ c14nRunTest(const char* xml_filename, int with_comments, int mode,
 	ret = -1;
     }
 
+    if (ret >= 0) {
+        xmlBufferPtr digest = xmlBufferCreate();
+
+        if ((xmlC14NDocDigest(doc, (xpath) ? xpath->nodesetval : NULL,
+                              mode, inclusive_namespaces, with_comments,
+                              c14nDigestAppend, digest) < 0) ||
+            (compareFileMem(result_file,
+                            (const char *) xmlBufferContent(digest),
+                            xmlBufferLength(digest)))) {
+            fprintf(stderr, "Digest result mismatch for %s\n", xml_filename);
+            ret = -1;
+        }
+        xmlBufferFree(digest);
+    }
+
+#ifdef LIBXML_READER_ENABLED
+    if ((ret >= 0) && (xpath == NULL)) {
+        if (c14nRunReaderTest(xml_filename, with_comments, mode,
+                              inclusive_namespaces, result_file) < 0)
+            ret = -1;
+    }
+#endif
+
     /*
      * Cleanup
      */
@@ -4512,10 +4584,12 @@ static xmlThreadParams threadParams[] = {
 };
 static const unsigned int num_threads = sizeof(threadParams) /
                                         sizeof(threadParams[0]);
+static xmlDictPtr threadDict;
 
 static void *
 thread_specific_data(void *private_data)
 {
+    xmlParserCtxtPtr ctxt;
     xmlDocPtr myDoc;
     xmlThreadParams *params = (xmlThreadParams *) private_data;
     const char *filename = params->filename;
@@ -4538,6 +4612,26 @@ thread_specific_data(void *private_data)
         printf("parse failed\n");
         okay = 0;
     }
+
+    /* Parse again using a dictionary shared between threads */
+    ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL) {
+        params->okay = 0;
+        return(NULL);
+    }
+    xmlDictFree(ctxt->dict);
+    ctxt->dict = threadDict;
+    xmlDictReference(threadDict);
+    myDoc = xmlCtxtReadFile(ctxt, filename, NULL,
+                            XML_PARSE_NOENT | XML_PARSE_DTDLOAD);
+    if ((myDoc == NULL) || (myDoc->dict != threadDict) ||
+        (xmlDictOwns(threadDict, xmlDocGetRootElement(myDoc)->name) != 1)) {
+        printf("parse with shared dictionary failed\n");
+        okay = 0;
+    }
+    xmlFreeDoc(myDoc);
+    xmlFreeParserCtxt(ctxt);
+
     params->okay = okay;
     return(NULL);
 }
@@ -4565,8 +4659,14 @@ testThread(void)
     int res = 0;
 
     xmlInitParser();
+    threadDict = xmlDictCreateConcurrent();
+    if (threadDict == NULL)
+        return(1);
     for (repeat = 0; repeat < TEST_REPEAT_COUNT; repeat++) {
         xmlLoadCatalog(catalog);
+        /* Memoized lookups are reset by xmlCatalogCleanup */
+        if (repeat % 2)
+            xmlCatalogSetMemoLimit(100);
         nb_tests++;
 
         for (i = 0; i < num_threads; i++) {
@@ -4612,6 +4712,7 @@ testThread(void)
         }
     }
 
+    xmlDictFree(threadDict);
     return (res);
 }
 
@@ -4628,9 +4729,15 @@ testThread(void)
     int res = 0;
 
     xmlInitParser();
+    threadDict = xmlDictCreateConcurrent();
+    if (threadDict == NULL)
+        return(1);
 
     for (repeat = 0; repeat < 500; repeat++) {
         xmlLoadCatalog(catalog);
+        /* Memoized lookups are reset by xmlCatalogCleanup */
+        if (repeat % 2)
+            xmlCatalogSetMemoLimit(100);
         nb_tests++;
 
         for (i = 0; i < num_threads; i++) {
@@ -4662,6 +4769,7 @@ testThread(void)
                 res = 1;
             }
     }
+    xmlDictFree(threadDict);
     return (res);
 }
 #endif
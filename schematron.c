@@ -36,9 +36,20 @@
 #include <libxml/schematron.h>
 
 #include "private/error.h"
+#include "private/memory.h"
+#include "private/pattern.h"
+#include "private/threads.h"
+#include "private/xpath.h"
+
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #define XML_SCHEMATRON_PARALLEL
+#endif
 
 #define SCHEMATRON_PARSE_OPTIONS XML_PARSE_NOENT
 
+/* Maximum number of names in a union of rule contexts for the index */
+#define SCHEMATRON_MAX_CONTEXT_NAMES 20
+
 #define SCT_OLD_NS BAD_CAST "http://www.ascc.net/xml/schematron"
 
 #define XML_SCHEMATRON_NS BAD_CAST "http://purl.oclc.org/dsdl/schematron"
@@ -77,6 +88,7 @@ struct _xmlSchematronLet {
     xmlSchematronLetPtr next; /* the next let variable in the list */
     xmlChar *name;            /* the name of the variable */
     xmlXPathCompExprPtr comp; /* the compiled expression */
+    int expr;                 /* index in the evaluation cache or -1 */
 };
 
 /**
@@ -91,6 +103,7 @@ struct _xmlSchematronTest {
     xmlChar *test;              /* the expression to test */
     xmlXPathCompExprPtr comp;   /* the compiled expression */
     xmlChar *report;            /* the message to report */
+    int expr;                   /* index in the evaluation cache or -1 */
 };
 
 /**
@@ -107,6 +120,8 @@ struct _xmlSchematronRule {
     xmlPatternPtr pattern;      /* the compiled pattern associated */
     xmlChar *report;            /* the message to report */
     xmlSchematronLetPtr lets;   /* the list of let variables */
+    struct _xmlSchematronPattern *parent; /* the pattern of the rule */
+    int nbTests;                /* the number of tests */
 };
 
 /**
@@ -118,6 +133,18 @@ struct _xmlSchematronPattern {
     xmlSchematronPatternPtr next;/* the next pattern in the list */
     xmlSchematronRulePtr rules; /* the list of rules */
     xmlChar *name;              /* the name of the pattern */
+    int no;                     /* the index of the pattern */
+};
+
+/**
+ * The rules whose context may match a node, in document order
+ */
+typedef struct _xmlSchematronRuleList xmlSchematronRuleList;
+typedef xmlSchematronRuleList *xmlSchematronRuleListPtr;
+struct _xmlSchematronRuleList {
+    int nbRules;
+    int maxRules;
+    xmlSchematronRulePtr *rules;
 };
 
 /**
@@ -142,6 +169,10 @@ struct _xmlSchematron {
     int nbNamespaces;           /* number of namespaces in the array */
     int maxNamespaces;          /* size of the array */
     const xmlChar **namespaces; /* the array of namespaces */
+
+    int nbExprs;                /* number of cached expressions */
+    xmlHashTablePtr ruleLists;  /* rule lists indexed by element name */
+    xmlSchematronRuleList anyRules; /* rules for all other nodes */
 };
 
 /**
@@ -158,6 +189,12 @@ struct _xmlSchematronValidCtxt {
     xmlSchematronPtr schema;
     xmlXPathContextPtr xctxt;
 
+    /* results of the cached expressions and the nodes they belong to */
+    xmlNodePtr *exprNodes;
+    xmlXPathObjectPtr *exprValues;
+
+    int parallelThreads;        /* threads evaluating the tests */
+
     FILE *outputFile;           /* if using XML_SCHEMATRON_OUT_FILE */
     xmlBufferPtr outputBuffer;  /* if using XML_SCHEMATRON_OUT_BUFFER */
 #ifdef LIBXML_OUTPUT_ENABLED
@@ -196,6 +233,8 @@ struct _xmlSchematronParserCtxt {
     int maxIncludes;            /* size of the array */
     xmlNodePtr *includes;       /* the array of includes */
 
+    xmlHashTablePtr exprs;      /* cache index of the expressions */
+
     /* error reporting data */
     void *userData;                      /* user specific data block */
     xmlSchematronValidityErrorFunc error;/* the callback in case of errors */
@@ -322,6 +361,44 @@ xmlSchematronVErr(xmlSchematronValidCtxtPtr ctxt, int error,
  *                                                                      *
  ************************************************************************/
 
+/**
+ * Get the index of an expression in the evaluation cache. Identical
+ * expressions without variable references give the same result
+ * at a given node, so they share an entry and are evaluated once.
+ *
+ * @param ctxt  the schema parsing context
+ * @param expr  the expression string
+ * @param comp  the compiled expression
+ * @returns the index or -1 if the result can't be cached
+ */
+static int
+xmlSchematronExprIndex(xmlSchematronParserCtxtPtr ctxt, const xmlChar *expr,
+                       xmlXPathCompExprPtr comp)
+{
+    void *no;
+
+    if (xmlXPathCompExprUsesVariables(comp))
+        return(-1);
+
+    if (ctxt->exprs == NULL) {
+        ctxt->exprs = xmlHashCreateDict(0, ctxt->dict);
+        if (ctxt->exprs == NULL) {
+            xmlSchematronPErrMemory(ctxt);
+            return(-1);
+        }
+    }
+    no = xmlHashLookup(ctxt->exprs, expr);
+    if (no != NULL)
+        return(XML_PTR_TO_INT(no) - 1);
+
+    if (xmlHashAdd(ctxt->exprs, expr,
+                   XML_INT_TO_PTR(ctxt->schema->nbExprs + 1)) < 0) {
+        xmlSchematronPErrMemory(ctxt);
+        return(-1);
+    }
+    return(ctxt->schema->nbExprs++);
+}
+
 /**
  * Add a test to a schematron
  *
@@ -369,7 +446,9 @@ xmlSchematronAddTest(xmlSchematronParserCtxtPtr ctxt,
     ret->test = test;
     ret->comp = comp;
     ret->report = report;
+    ret->expr = xmlSchematronExprIndex(ctxt, test, comp);
     ret->next = NULL;
+    rule->nbTests++;
     if (rule->tests == NULL) {
         rule->tests = ret;
     } else {
@@ -471,6 +550,7 @@ xmlSchematronAddRule(xmlSchematronParserCtxtPtr ctxt, xmlSchematronPtr schema,
     ret->report = report;
     ret->next = NULL;
     ret->lets = NULL;
+    ret->parent = pat;
     if (schema->rules == NULL) {
         schema->rules = ret;
     } else {
@@ -544,6 +624,7 @@ xmlSchematronAddPattern(xmlSchematronParserCtxtPtr ctxt,
     }
     memset(ret, 0, sizeof(xmlSchematronPattern));
     ret->name = name;
+    ret->no = schema->nbPattern;
     ret->next = NULL;
     if (schema->patterns == NULL) {
         schema->patterns = ret;
@@ -575,6 +656,137 @@ xmlSchematronFreePatterns(xmlSchematronPatternPtr patterns) {
     }
 }
 
+/**
+ * Append a rule to a rule list.
+ *
+ * @param list  a rule list
+ * @param rule  the rule to add
+ * @returns 0 in case of success, -1 in case of error
+ */
+static int
+xmlSchematronAddRuleToList(xmlSchematronRuleListPtr list,
+                           xmlSchematronRulePtr rule)
+{
+    if ((list->nbRules > 0) && (list->rules[list->nbRules - 1] == rule))
+        return(0);
+    if (list->nbRules >= list->maxRules) {
+        xmlSchematronRulePtr *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(list->maxRules, sizeof(tmp[0]),
+                                  4, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(list->rules, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        list->rules = tmp;
+        list->maxRules = newSize;
+    }
+    list->rules[list->nbRules++] = rule;
+    return(0);
+}
+
+static void
+xmlSchematronFreeRuleList(void *payload, const xmlChar *name ATTRIBUTE_UNUSED)
+{
+    xmlSchematronRuleListPtr list = payload;
+
+    xmlFree(list->rules);
+    xmlFree(list);
+}
+
+typedef struct {
+    xmlSchematronRulePtr rule;
+    int error;
+} xmlSchematronAddAnyData;
+
+static void
+xmlSchematronAddAnyRule(void *payload, void *data,
+                        const xmlChar *name ATTRIBUTE_UNUSED)
+{
+    xmlSchematronAddAnyData *add = data;
+
+    if (xmlSchematronAddRuleToList(payload, add->rule) < 0)
+        add->error = 1;
+}
+
+/**
+ * Index the rules by the names of the elements their context can
+ * match, so that validation only tries the rules relevant for a
+ * node instead of matching every rule context against every node.
+ * Each list also holds the rules which can match any node, all
+ * lists keep the order of the rules in the schema.
+ *
+ * @param ctxt  the schema parsing context
+ * @param schema  the schema
+ * @returns 0 in case of success, -1 in case of error
+ */
+static int
+xmlSchematronIndexRules(xmlSchematronParserCtxtPtr ctxt,
+                        xmlSchematronPtr schema)
+{
+    const xmlChar *names[SCHEMATRON_MAX_CONTEXT_NAMES];
+    xmlSchematronRuleListPtr list;
+    xmlSchematronRulePtr rule;
+    int nb, i;
+
+    schema->ruleLists = xmlHashCreateDict(0, schema->dict);
+    if (schema->ruleLists == NULL)
+        goto mem_error;
+
+    /*
+     * Create the lists first, rules matching any node must be
+     * added to all of them.
+     */
+    for (rule = schema->rules; rule != NULL; rule = rule->next) {
+        nb = xmlPatternGetElementNames(rule->pattern, names,
+                                       SCHEMATRON_MAX_CONTEXT_NAMES);
+        for (i = 0; i < nb; i++) {
+            if (xmlHashLookup(schema->ruleLists, names[i]) != NULL)
+                continue;
+            list = xmlMalloc(sizeof(*list));
+            if (list == NULL)
+                goto mem_error;
+            memset(list, 0, sizeof(*list));
+            if (xmlHashAdd(schema->ruleLists, names[i], list) < 0) {
+                xmlFree(list);
+                goto mem_error;
+            }
+        }
+    }
+
+    for (rule = schema->rules; rule != NULL; rule = rule->next) {
+        if (rule->pattern == NULL)
+            continue;
+        nb = xmlPatternGetElementNames(rule->pattern, names,
+                                       SCHEMATRON_MAX_CONTEXT_NAMES);
+        if (nb < 0) {
+            xmlSchematronAddAnyData add;
+
+            if (xmlSchematronAddRuleToList(&schema->anyRules, rule) < 0)
+                goto mem_error;
+            add.rule = rule;
+            add.error = 0;
+            xmlHashScan(schema->ruleLists, xmlSchematronAddAnyRule, &add);
+            if (add.error)
+                goto mem_error;
+        } else {
+            for (i = 0; i < nb; i++) {
+                list = xmlHashLookup(schema->ruleLists, names[i]);
+                if (xmlSchematronAddRuleToList(list, rule) < 0)
+                    goto mem_error;
+            }
+        }
+    }
+
+    return(0);
+
+mem_error:
+    xmlSchematronPErrMemory(ctxt);
+    return(-1);
+}
+
 /**
  * Allocate a new Schematron structure.
  *
@@ -615,6 +827,8 @@ xmlSchematronFree(xmlSchematron *schema)
     if (schema->namespaces != NULL)
         xmlFree((char **) schema->namespaces);
 
+    xmlHashFree(schema->ruleLists, xmlSchematronFreeRuleList);
+    xmlFree(schema->anyRules.rules);
     xmlSchematronFreeRules(schema->rules);
     xmlSchematronFreePatterns(schema->patterns);
     xmlDictFree(schema->dict);
@@ -748,6 +962,7 @@ xmlSchematronFreeParserCtxt(xmlSchematronParserCtxt *ctxt)
     }
     if (ctxt->namespaces != NULL)
         xmlFree((char **) ctxt->namespaces);
+    xmlHashFree(ctxt->exprs, NULL);
     xmlDictFree(ctxt->dict);
     xmlFree(ctxt);
 }
@@ -1007,6 +1222,7 @@ xmlSchematronParseRule(xmlSchematronParserCtxtPtr ctxt,
             let = (xmlSchematronLetPtr) xmlMalloc(sizeof(xmlSchematronLet));
             let->name = name;
             let->comp = var_comp;
+            let->expr = xmlSchematronExprIndex(ctxt, value, var_comp);
             let->next = NULL;
 
             /* add new let variable to the beginning of the list */
@@ -1349,6 +1565,9 @@ exit:
         if (ctxt->nberrors != 0) {
             xmlSchematronFree(ret);
             ret = NULL;
+        } else if (xmlSchematronIndexRules(ctxt, ret) < 0) {
+            xmlSchematronFree(ret);
+            ret = NULL;
         } else {
             ret->namespaces = ctxt->namespaces;
             ret->nbNamespaces = ctxt->nbNamespaces;
@@ -1678,6 +1897,66 @@ xmlSchematronSetValidStructuredErrors(xmlSchematronValidCtxt *ctxt,
     ctxt->userData = ctx;
 }
 
+/**
+ * Evaluate the tests of a Schematron with multiple threads.
+ *
+ * The calling thread matches the rule contexts against the document,
+ * then up to `nbThreads` threads evaluate the tests, each with its
+ * own XPath context. Reports are generated afterwards in the same
+ * order as with sequential validation, so error handlers are only
+ * invoked from the calling thread. The document must not be modified
+ * during validation.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a Schematron validation context
+ * @param nbThreads  maximum number of threads or 0 to disable
+ * @returns 0 on success or -1 if threads aren't supported.
+ */
+int
+xmlSchematronSetValidParallel(xmlSchematronValidCtxt *ctxt, int nbThreads)
+{
+    if (ctxt == NULL)
+        return(-1);
+
+    if (nbThreads <= 1) {
+        ctxt->parallelThreads = 0;
+        return(0);
+    }
+
+#ifdef XML_SCHEMATRON_PARALLEL
+    ctxt->parallelThreads = nbThreads;
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+/**
+ * Create an XPath context with the namespaces of a schema.
+ *
+ * @param schema  a precompiled XML Schematrons
+ * @returns the XPath context or NULL in case of error
+ */
+static xmlXPathContextPtr
+xmlSchematronNewXPathContext(xmlSchematronPtr schema)
+{
+    xmlXPathContextPtr xctxt;
+    int i;
+
+    xctxt = xmlXPathNewContext(NULL);
+    if (xctxt == NULL)
+        return(NULL);
+    for (i = 0;i < schema->nbNamespaces;i++) {
+        if ((schema->namespaces[2 * i] == NULL) ||
+            (schema->namespaces[2 * i + 1] == NULL))
+            break;
+        xmlXPathRegisterNs(xctxt, schema->namespaces[2 * i + 1],
+                           schema->namespaces[2 * i]);
+    }
+    return(xctxt);
+}
+
 /**
  * Create an XML Schematrons validation context based on the given schema.
  *
@@ -1688,7 +1967,6 @@ xmlSchematronSetValidStructuredErrors(xmlSchematronValidCtxt *ctxt,
 xmlSchematronValidCtxt *
 xmlSchematronNewValidCtxt(xmlSchematron *schema, int options)
 {
-    int i;
     xmlSchematronValidCtxtPtr ret;
 
     if (schema == NULL)
@@ -1702,23 +1980,64 @@ xmlSchematronNewValidCtxt(xmlSchematron *schema, int options)
     memset(ret, 0, sizeof(xmlSchematronValidCtxt));
     ret->type = XML_STRON_CTXT_VALIDATOR;
     ret->schema = schema;
-    ret->xctxt = xmlXPathNewContext(NULL);
+    ret->xctxt = xmlSchematronNewXPathContext(schema);
     ret->flags = options;
     if (ret->xctxt == NULL) {
         xmlSchematronPErrMemory(NULL);
         xmlSchematronFreeValidCtxt(ret);
         return (NULL);
     }
-    for (i = 0;i < schema->nbNamespaces;i++) {
-        if ((schema->namespaces[2 * i] == NULL) ||
-            (schema->namespaces[2 * i + 1] == NULL))
-            break;
-        xmlXPathRegisterNs(ret->xctxt, schema->namespaces[2 * i + 1],
-                           schema->namespaces[2 * i]);
-    }
     return (ret);
 }
 
+/**
+ * Allocate the evaluation cache of a validation context.
+ *
+ * @param ctxt  the schema validation context
+ * @returns 0 in case of success, -1 in case of error
+ */
+static int
+xmlSchematronInitCache(xmlSchematronValidCtxtPtr ctxt)
+{
+    int nbExprs = ctxt->schema->nbExprs;
+
+    if ((nbExprs == 0) || (ctxt->exprNodes != NULL))
+        return(0);
+
+    ctxt->exprNodes = xmlMalloc(nbExprs * sizeof(ctxt->exprNodes[0]));
+    ctxt->exprValues = xmlMalloc(nbExprs * sizeof(ctxt->exprValues[0]));
+    if ((ctxt->exprNodes == NULL) || (ctxt->exprValues == NULL)) {
+        xmlFree(ctxt->exprNodes);
+        xmlFree(ctxt->exprValues);
+        ctxt->exprNodes = NULL;
+        ctxt->exprValues = NULL;
+        xmlSchematronVErrMemory(ctxt);
+        return(-1);
+    }
+    memset(ctxt->exprNodes, 0, nbExprs * sizeof(ctxt->exprNodes[0]));
+    memset(ctxt->exprValues, 0, nbExprs * sizeof(ctxt->exprValues[0]));
+    return(0);
+}
+
+/**
+ * Drop the results cached during a validation.
+ *
+ * @param ctxt  the schema validation context
+ */
+static void
+xmlSchematronClearCache(xmlSchematronValidCtxtPtr ctxt)
+{
+    int i;
+
+    if (ctxt->exprNodes == NULL)
+        return;
+    for (i = 0; i < ctxt->schema->nbExprs; i++) {
+        xmlXPathFreeObject(ctxt->exprValues[i]);
+        ctxt->exprValues[i] = NULL;
+        ctxt->exprNodes[i] = NULL;
+    }
+}
+
 /**
  * Free the resources associated to the schema validation context
  *
@@ -1733,9 +2052,64 @@ xmlSchematronFreeValidCtxt(xmlSchematronValidCtxt *ctxt)
         xmlXPathFreeContext(ctxt->xctxt);
     if (ctxt->dict != NULL)
         xmlDictFree(ctxt->dict);
+    xmlSchematronClearCache(ctxt);
+    xmlFree(ctxt->exprNodes);
+    xmlFree(ctxt->exprValues);
     xmlFree(ctxt);
 }
 
+/**
+ * Evaluate an expression at a node. The results of expressions
+ * shared by several tests or let variables are cached for the
+ * current node.
+ *
+ * @param ctxt  the schema validation context
+ * @param comp  the compiled expression
+ * @param expr  the index in the evaluation cache or -1
+ * @param instance  the document instance tree
+ * @param cur  the current node in the instance
+ * @returns the result or NULL in case of error. Cached results
+ *         are owned by the context.
+ */
+static xmlXPathObjectPtr
+xmlSchematronEval(xmlSchematronValidCtxtPtr ctxt, xmlXPathCompExprPtr comp,
+                  int expr, xmlDocPtr instance, xmlNodePtr cur)
+{
+    xmlXPathObjectPtr ret;
+
+    if ((expr >= 0) && (ctxt->exprNodes[expr] == cur))
+        return(ctxt->exprValues[expr]);
+
+    ctxt->xctxt->doc = instance;
+    ctxt->xctxt->node = cur;
+    ret = xmlXPathCompiledEval(comp, ctxt->xctxt);
+    if ((ret != NULL) && (expr >= 0)) {
+        xmlXPathFreeObject(ctxt->exprValues[expr]);
+        ctxt->exprNodes[expr] = cur;
+        ctxt->exprValues[expr] = ret;
+    }
+    return(ret);
+}
+
+/**
+ * Get the rules whose context may match a node.
+ *
+ * @param schema  the schema
+ * @param cur  the current node in the instance
+ * @returns the list of rules
+ */
+static xmlSchematronRuleListPtr
+xmlSchematronGetRules(xmlSchematronPtr schema, xmlNodePtr cur)
+{
+    xmlSchematronRuleListPtr list = NULL;
+
+    if (cur->type == XML_ELEMENT_NODE)
+        list = xmlHashLookup(schema->ruleLists, cur->name);
+    if (list == NULL)
+        list = &schema->anyRules;
+    return(list);
+}
+
 static xmlNodePtr
 xmlSchematronNextNode(xmlNodePtr cur) {
     if (cur->children != NULL) {
@@ -1772,26 +2146,24 @@ xmlSchematronNextNode(xmlNodePtr cur) {
 }
 
 /**
- * Validate a rule against a tree instance at a given position
+ * Evaluate the expression of a test at a given position
  *
  * @param ctxt  the schema validation context
  * @param test  the current test
  * @param instance  the document instance tree
  * @param cur  the current node in the instance
- * @param pattern  a pattern
- * @returns 1 in case of success, 0 if error and -1 in case of internal error
+ * @returns 1 if the expression is false, 0 otherwise
  */
 static int
-xmlSchematronRunTest(xmlSchematronValidCtxtPtr ctxt,
-     xmlSchematronTestPtr test, xmlDocPtr instance, xmlNodePtr cur, xmlSchematronPatternPtr pattern)
+xmlSchematronEvalTest(xmlSchematronValidCtxtPtr ctxt,
+                      xmlSchematronTestPtr test, xmlDocPtr instance,
+                      xmlNodePtr cur)
 {
     xmlXPathObjectPtr ret;
     int failed;
 
     failed = 0;
-    ctxt->xctxt->doc = instance;
-    ctxt->xctxt->node = cur;
-    ret = xmlXPathCompiledEval(test->comp, ctxt->xctxt);
+    ret = xmlSchematronEval(ctxt, test->comp, test->expr, instance, cur);
     if (ret == NULL) {
         failed = 1;
     } else {
@@ -1820,14 +2192,53 @@ xmlSchematronRunTest(xmlSchematronValidCtxtPtr ctxt,
                 failed = 1;
                 break;
         }
-        xmlXPathFreeObject(ret);
+        if (test->expr < 0)
+            xmlXPathFreeObject(ret);
     }
+
+    return(failed);
+}
+
+/**
+ * Account for and report the result of a test
+ *
+ * @param ctxt  the schema validation context
+ * @param test  the current test
+ * @param cur  the current node in the instance
+ * @param pattern  a pattern
+ * @param failed  whether the expression of the test is false
+ */
+static void
+xmlSchematronTestDone(xmlSchematronValidCtxtPtr ctxt,
+                      xmlSchematronTestPtr test, xmlNodePtr cur,
+                      xmlSchematronPatternPtr pattern, int failed)
+{
     if ((failed) && (test->type == XML_SCHEMATRON_ASSERT))
         ctxt->nberrors++;
     else if ((!failed) && (test->type == XML_SCHEMATRON_REPORT))
         ctxt->nberrors++;
 
     xmlSchematronReportSuccess(ctxt, test, cur, pattern, !failed);
+}
+
+/**
+ * Validate a rule against a tree instance at a given position
+ *
+ * @param ctxt  the schema validation context
+ * @param test  the current test
+ * @param instance  the document instance tree
+ * @param cur  the current node in the instance
+ * @param pattern  a pattern
+ * @returns 1 in case of success, 0 if error and -1 in case of internal error
+ */
+static int
+xmlSchematronRunTest(xmlSchematronValidCtxtPtr ctxt,
+     xmlSchematronTestPtr test, xmlDocPtr instance, xmlNodePtr cur, xmlSchematronPatternPtr pattern)
+{
+    int failed;
+
+    failed = xmlSchematronEvalTest(ctxt, test, instance, cur);
+    xmlSchematronTestDone(ctxt, test, cur, pattern, failed);
 
     return(!failed);
 }
@@ -1850,10 +2261,11 @@ xmlSchematronRegisterVariables(xmlSchematronValidCtxtPtr vctxt,
 {
     xmlXPathObjectPtr let_eval;
 
-    ctxt->doc = instance;
-    ctxt->node = cur;
     while (let != NULL) {
-        let_eval = xmlXPathCompiledEval(let->comp, ctxt);
+        let_eval = xmlSchematronEval(vctxt, let->comp, let->expr,
+                                     instance, cur);
+        if ((let_eval != NULL) && (let->expr >= 0))
+            let_eval = xmlXPathObjectCopy(let_eval);
         if (let_eval == NULL) {
             xmlSchematronVErr(vctxt, XML_ERR_INTERNAL_ERROR,
                               "Evaluation of compiled expression failed\n",
@@ -1894,6 +2306,371 @@ xmlSchematronUnregisterVariables(xmlSchematronValidCtxtPtr vctxt,
     return 0;
 }
 
+typedef struct {
+    xmlNodePtr node;
+    xmlSchematronRulePtr rule;
+    int outcomes;               /* index of the outcomes of the tests */
+} xmlSchematronMatch;
+
+/*
+ * Outcomes of tests evaluated in advance
+ */
+#define XML_SCHEMATRON_PASSED 0
+#define XML_SCHEMATRON_FAILED 1
+#define XML_SCHEMATRON_RETRY 2  /* evaluation raised errors */
+
+/**
+ * Find the rules matching the nodes of a document in a single pass.
+ * If `byPattern` is set, the matches are sorted by pattern and
+ * `ends` receives the end of the matches of each pattern, otherwise
+ * they are in document order.
+ *
+ * @param ctxt  the schema validation context
+ * @param root  the document element of the instance
+ * @param byPattern  whether to sort the matches by pattern
+ * @param out  the matches
+ * @param ends  the end of the matches of each pattern
+ * @param nbOutcomes  the total number of tests of the matches
+ * @returns the number of matches or -1 in case of error
+ */
+static int
+xmlSchematronFindMatches(xmlSchematronValidCtxtPtr ctxt, xmlNodePtr root,
+                         int byPattern, xmlSchematronMatch **out,
+                         int **ends, int *nbOutcomes)
+{
+    xmlSchematronMatch *matches = NULL, *sorted;
+    xmlSchematronRuleListPtr list;
+    xmlSchematronRulePtr rule;
+    xmlNodePtr cur;
+    int nbMatches = 0, maxMatches = 0, outcomes = 0;
+    int nbPattern = ctxt->schema->nbPattern;
+    int *starts;
+    int i;
+
+    cur = root;
+    while (cur != NULL) {
+        list = xmlSchematronGetRules(ctxt->schema, cur);
+        for (i = 0; i < list->nbRules; i++) {
+            rule = list->rules[i];
+            if (xmlPatternMatch(rule->pattern, cur) != 1)
+                continue;
+            if (nbMatches >= maxMatches) {
+                xmlSchematronMatch *tmp;
+                int newSize;
+
+                newSize = xmlGrowCapacity(maxMatches, sizeof(tmp[0]),
+                                          32, XML_MAX_ITEMS);
+                if (newSize < 0)
+                    goto mem_error;
+                tmp = xmlRealloc(matches, newSize * sizeof(tmp[0]));
+                if (tmp == NULL)
+                    goto mem_error;
+                matches = tmp;
+                maxMatches = newSize;
+            }
+            if (outcomes > XML_MAX_ITEMS - rule->nbTests)
+                goto mem_error;
+            matches[nbMatches].node = cur;
+            matches[nbMatches].rule = rule;
+            matches[nbMatches].outcomes = outcomes;
+            outcomes += rule->nbTests;
+            nbMatches++;
+        }
+
+        cur = xmlSchematronNextNode(cur);
+    }
+    *nbOutcomes = outcomes;
+
+    if (!byPattern) {
+        *out = matches;
+        *ends = NULL;
+        return(nbMatches);
+    }
+
+    /*
+     * Stable counting sort of the matches by pattern
+     */
+    sorted = xmlMalloc((nbMatches + 1) * sizeof(sorted[0]));
+    starts = xmlMalloc((nbPattern + 1) * sizeof(starts[0]));
+    if ((sorted == NULL) || (starts == NULL)) {
+        xmlFree(sorted);
+        xmlFree(starts);
+        goto mem_error;
+    }
+    memset(starts, 0, (nbPattern + 1) * sizeof(starts[0]));
+    for (i = 0; i < nbMatches; i++)
+        starts[matches[i].rule->parent->no + 1]++;
+    for (i = 0; i < nbPattern; i++)
+        starts[i + 1] += starts[i];
+    /* Afterwards starts[no] is the end of the matches of a pattern */
+    for (i = 0; i < nbMatches; i++)
+        sorted[starts[matches[i].rule->parent->no]++] = matches[i];
+    xmlFree(matches);
+
+    *out = sorted;
+    *ends = starts;
+    return(nbMatches);
+
+mem_error:
+    xmlFree(matches);
+    xmlSchematronVErrMemory(ctxt);
+    return(-1);
+}
+
+/**
+ * Run the tests of a rule at a node matching its context
+ *
+ * @param ctxt  the schema validation context
+ * @param rule  the rule
+ * @param instance  the document instance tree
+ * @param cur  the current node in the instance
+ * @returns 0 in case of success, -1 if the let variables failed
+ */
+static int
+xmlSchematronRunRule(xmlSchematronValidCtxtPtr ctxt,
+                     xmlSchematronRulePtr rule, xmlDocPtr instance,
+                     xmlNodePtr cur)
+{
+    xmlSchematronTestPtr test;
+    int ret = 0;
+
+    if (xmlSchematronRegisterVariables(ctxt, ctxt->xctxt, rule->lets,
+                                       instance, cur))
+        ret = -1;
+
+    for (test = rule->tests; test != NULL; test = test->next)
+        xmlSchematronRunTest(ctxt, test, instance, cur, rule->parent);
+
+    if (xmlSchematronUnregisterVariables(ctxt, ctxt->xctxt, rule->lets))
+        ret = -1;
+
+    return(ret);
+}
+
+/**
+ * Account for and report the tests of a match. Without outcomes
+ * or if their evaluation raised errors, the tests are run again.
+ *
+ * @param ctxt  the schema validation context
+ * @param match  the match
+ * @param instance  the document instance tree
+ * @param outcomes  the outcomes of the tests or NULL
+ * @returns 0 in case of success, -1 if the let variables failed
+ */
+static int
+xmlSchematronFinishMatch(xmlSchematronValidCtxtPtr ctxt,
+                         xmlSchematronMatch *match, xmlDocPtr instance,
+                         const unsigned char *outcomes)
+{
+    xmlSchematronRulePtr rule = match->rule;
+    xmlSchematronTestPtr test;
+    int ret = 0, report = 0;
+    int i;
+
+    if ((outcomes == NULL) ||
+        ((rule->nbTests > 0) &&
+         (outcomes[match->outcomes] == XML_SCHEMATRON_RETRY)))
+        return(xmlSchematronRunRule(ctxt, rule, instance, match->node));
+
+    outcomes += match->outcomes;
+    for (test = rule->tests, i = 0; test != NULL; test = test->next, i++) {
+        if ((outcomes[i] == XML_SCHEMATRON_FAILED) ==
+            (test->type == XML_SCHEMATRON_ASSERT))
+            report = 1;
+    }
+    /* Only failures produce output */
+    if (!report)
+        return(0);
+
+    /* Messages can refer to the let variables */
+    if (xmlSchematronRegisterVariables(ctxt, ctxt->xctxt, rule->lets,
+                                       instance, match->node))
+        ret = -1;
+
+    for (test = rule->tests, i = 0; test != NULL; test = test->next, i++)
+        xmlSchematronTestDone(ctxt, test, match->node, rule->parent,
+                              outcomes[i] == XML_SCHEMATRON_FAILED);
+
+    if (xmlSchematronUnregisterVariables(ctxt, ctxt->xctxt, rule->lets))
+        ret = -1;
+
+    return(ret);
+}
+
+#ifdef XML_SCHEMATRON_PARALLEL
+/* Number of matches handed to a worker at once */
+#define XML_SCHEMATRON_PAR_CHUNK 32
+
+typedef struct {
+    xmlDocPtr instance;
+    xmlSchematronMatch *matches;
+    int nbMatches;
+    unsigned char *outcomes;
+    int next;                   /* next match for the workers */
+    xmlMutex lock;
+} xmlSchematronParRun;
+
+/*
+ * Workers have their own validation and XPath contexts. Errors are
+ * only flagged, the calling thread runs the tests again to report
+ * them.
+ */
+typedef struct {
+    xmlSchematronParRun *run;
+    xmlSchematronValidCtxt vctxt;
+    int error;
+} xmlSchematronParWorker;
+
+static void
+xmlSchematronParError(void *data, const xmlError *error ATTRIBUTE_UNUSED)
+{
+    ((xmlSchematronParWorker *) data)->error = 1;
+}
+
+static void
+xmlSchematronParWork(void *data)
+{
+    xmlSchematronParWorker *worker = data;
+    xmlSchematronParRun *run = worker->run;
+    xmlSchematronValidCtxtPtr vctxt = &worker->vctxt;
+    xmlSchematronMatch *match;
+    xmlSchematronTestPtr test;
+    unsigned char *outcomes;
+    int start, end, i, j;
+
+    while (1) {
+        xmlMutexLock(&run->lock);
+        start = run->next;
+        if (start < run->nbMatches)
+            run->next += XML_SCHEMATRON_PAR_CHUNK;
+        xmlMutexUnlock(&run->lock);
+        if (start >= run->nbMatches)
+            break;
+
+        end = start + XML_SCHEMATRON_PAR_CHUNK;
+        if (end > run->nbMatches)
+            end = run->nbMatches;
+        for (i = start; i < end; i++) {
+            match = &run->matches[i];
+            outcomes = run->outcomes + match->outcomes;
+
+            worker->error = 0;
+            xmlSchematronRegisterVariables(vctxt, vctxt->xctxt,
+                    match->rule->lets, run->instance, match->node);
+            for (test = match->rule->tests, j = 0; test != NULL;
+                 test = test->next, j++) {
+                outcomes[j] = xmlSchematronEvalTest(vctxt, test,
+                                                    run->instance,
+                                                    match->node) ?
+                              XML_SCHEMATRON_FAILED :
+                              XML_SCHEMATRON_PASSED;
+            }
+            xmlSchematronUnregisterVariables(vctxt, vctxt->xctxt,
+                                             match->rule->lets);
+            if (worker->error)
+                memset(outcomes, XML_SCHEMATRON_RETRY,
+                       match->rule->nbTests);
+        }
+    }
+}
+
+static void
+xmlSchematronParFreeWorker(xmlSchematronParWorker *worker)
+{
+    xmlSchematronClearCache(&worker->vctxt);
+    xmlFree(worker->vctxt.exprNodes);
+    xmlFree(worker->vctxt.exprValues);
+    xmlXPathFreeContext(worker->vctxt.xctxt);
+}
+
+/**
+ * Evaluate the tests of the matches with multiple threads. The
+ * calling thread takes part in the evaluation.
+ *
+ * @param ctxt  the schema validation context
+ * @param instance  the document instance tree
+ * @param matches  the matches
+ * @param nbMatches  the number of matches
+ * @param nbOutcomes  the total number of tests of the matches
+ * @returns the outcomes of the tests or NULL if the matches must
+ *         be processed sequentially.
+ */
+static unsigned char *
+xmlSchematronParEvaluate(xmlSchematronValidCtxtPtr ctxt, xmlDocPtr instance,
+                         xmlSchematronMatch *matches, int nbMatches,
+                         int nbOutcomes)
+{
+    xmlSchematronParRun run;
+    xmlSchematronParWorker *workers;
+    xmlTaskGroup *group;
+    int nbWorkers, i;
+
+    nbWorkers = (nbMatches - 1) / XML_SCHEMATRON_PAR_CHUNK + 1;
+    if (nbWorkers > ctxt->parallelThreads)
+        nbWorkers = ctxt->parallelThreads;
+    if (nbWorkers <= 1)
+        return(NULL);
+
+    memset(&run, 0, sizeof(run));
+    run.instance = instance;
+    run.matches = matches;
+    run.nbMatches = nbMatches;
+    run.outcomes = xmlMalloc(nbOutcomes + 1);
+    workers = xmlMalloc(nbWorkers * sizeof(workers[0]));
+    if ((run.outcomes == NULL) || (workers == NULL)) {
+        xmlFree(run.outcomes);
+        xmlFree(workers);
+        return(NULL);
+    }
+    memset(workers, 0, nbWorkers * sizeof(workers[0]));
+
+    for (i = 0; i < nbWorkers; i++) {
+        xmlSchematronValidCtxtPtr vctxt = &workers[i].vctxt;
+
+        workers[i].run = &run;
+        vctxt->type = XML_STRON_CTXT_VALIDATOR;
+        vctxt->flags = ctxt->flags;
+        vctxt->schema = ctxt->schema;
+        vctxt->serror = xmlSchematronParError;
+        vctxt->userData = &workers[i];
+        vctxt->xctxt = xmlSchematronNewXPathContext(ctxt->schema);
+        if ((vctxt->xctxt == NULL) ||
+            (xmlSchematronInitCache(vctxt) < 0)) {
+            nbWorkers = i + 1;
+            goto error;
+        }
+        vctxt->xctxt->error = xmlSchematronParError;
+        vctxt->xctxt->userData = &workers[i];
+    }
+
+    /*
+     * Lazily collected IDs are registered when the document is
+     * first searched, which must not happen in parallel.
+     */
+    xmlGetID(instance, BAD_CAST "");
+
+    xmlInitMutex(&run.lock);
+    group = xmlNewTaskGroup();
+    for (i = 1; i < nbWorkers; i++)
+        xmlTaskGroupSubmit(group, xmlSchematronParWork, &workers[i]);
+    xmlSchematronParWork(&workers[0]);
+    xmlFreeTaskGroup(group);
+    xmlCleanupMutex(&run.lock);
+
+    for (i = 0; i < nbWorkers; i++)
+        xmlSchematronParFreeWorker(&workers[i]);
+    xmlFree(workers);
+    return(run.outcomes);
+
+error:
+    for (i = 0; i < nbWorkers; i++)
+        xmlSchematronParFreeWorker(&workers[i]);
+    xmlFree(workers);
+    xmlFree(run.outcomes);
+    return(NULL);
+}
+#endif /* XML_SCHEMATRON_PARALLEL */
+
 /**
  * Validate a tree instance against the schematron
  *
@@ -1907,8 +2684,10 @@ xmlSchematronValidateDoc(xmlSchematronValidCtxt *ctxt, xmlDoc *instance)
 {
     xmlNodePtr cur, root;
     xmlSchematronPatternPtr pattern;
+    xmlSchematronRuleListPtr list;
     xmlSchematronRulePtr rule;
-    xmlSchematronTestPtr test;
+    int quiet, ret = 0;
+    int i;
 
     if ((ctxt == NULL) || (ctxt->schema == NULL) ||
         (ctxt->schema->rules == NULL) || (instance == NULL))
@@ -1920,78 +2699,81 @@ xmlSchematronValidateDoc(xmlSchematronValidCtxt *ctxt, xmlDoc *instance)
         ctxt->nberrors++;
         return(1);
     }
-    if ((ctxt->flags & XML_SCHEMATRON_OUT_QUIET) ||
-        (ctxt->flags == 0)) {
+    if (xmlSchematronInitCache(ctxt) < 0)
+        return(-1);
+    quiet = ((ctxt->flags & XML_SCHEMATRON_OUT_QUIET) ||
+             (ctxt->flags == 0));
+    if ((quiet) && (ctxt->parallelThreads <= 1)) {
         /*
          * we are just trying to assert the validity of the document,
          * speed primes over the output, run in a single pass
          */
         cur = root;
-        while (cur != NULL) {
-            rule = ctxt->schema->rules;
-            while (rule != NULL) {
-                if (xmlPatternMatch(rule->pattern, cur) == 1) {
-                    test = rule->tests;
-
-                    if (xmlSchematronRegisterVariables(ctxt, ctxt->xctxt,
-                                rule->lets, instance, cur))
-                        return -1;
-
-                    while (test != NULL) {
-                        xmlSchematronRunTest(ctxt, test, instance, cur, (xmlSchematronPatternPtr)rule->pattern);
-                        test = test->next;
-                    }
-
-                    if (xmlSchematronUnregisterVariables(ctxt, ctxt->xctxt,
-                                rule->lets))
-                        return -1;
-
+        while ((cur != NULL) && (ret == 0)) {
+            list = xmlSchematronGetRules(ctxt->schema, cur);
+            for (i = 0; i < list->nbRules; i++) {
+                rule = list->rules[i];
+                if ((xmlPatternMatch(rule->pattern, cur) == 1) &&
+                    (xmlSchematronRunRule(ctxt, rule, instance, cur) < 0)) {
+                    ret = -1;
+                    break;
                 }
-                rule = rule->next;
             }
 
             cur = xmlSchematronNextNode(cur);
         }
     } else {
+        xmlSchematronMatch *matches;
+        unsigned char *outcomes = NULL;
+        int *ends;
+        int nbMatches, nbOutcomes;
+
         /*
-         * Process all contexts one at a time
+         * Find the matches of all patterns in a single pass. Reports
+         * are generated pattern by pattern in document order.
          */
-        pattern = ctxt->schema->patterns;
+        nbMatches = xmlSchematronFindMatches(ctxt, root, !quiet, &matches,
+                                             &ends, &nbOutcomes);
+        if (nbMatches < 0) {
+            xmlSchematronClearCache(ctxt);
+            return(-1);
+        }
 
-        while (pattern != NULL) {
-            xmlSchematronReportPattern(ctxt, pattern);
+#ifdef XML_SCHEMATRON_PARALLEL
+        if (ctxt->parallelThreads > 1)
+            outcomes = xmlSchematronParEvaluate(ctxt, instance, matches,
+                                                nbMatches, nbOutcomes);
+#endif
 
-            /*
-             * TODO convert the pattern rule to a direct XPath and
-             * compute directly instead of using the pattern matching
-             * over the full document...
-             * Check the exact semantic
-             */
-            cur = root;
-            while (cur != NULL) {
-                rule = pattern->rules;
-                while (rule != NULL) {
-                    if (xmlPatternMatch(rule->pattern, cur) == 1) {
-                        test = rule->tests;
-                        xmlSchematronRegisterVariables(ctxt, ctxt->xctxt,
-                                rule->lets, instance, cur);
-
-                        while (test != NULL) {
-                            xmlSchematronRunTest(ctxt, test, instance, cur, pattern);
-                            test = test->next;
-                        }
-
-                        xmlSchematronUnregisterVariables(ctxt, ctxt->xctxt,
-                                rule->lets);
-                    }
-                    rule = rule->patnext;
+        if (quiet) {
+            for (i = 0; i < nbMatches; i++) {
+                if (xmlSchematronFinishMatch(ctxt, &matches[i], instance,
+                                             outcomes) < 0) {
+                    ret = -1;
+                    break;
                 }
+            }
+        } else {
+            pattern = ctxt->schema->patterns;
+            while (pattern != NULL) {
+                xmlSchematronReportPattern(ctxt, pattern);
+
+                i = (pattern->no > 0) ? ends[pattern->no - 1] : 0;
+                for (; i < ends[pattern->no]; i++)
+                    xmlSchematronFinishMatch(ctxt, &matches[i], instance,
+                                             outcomes);
 
-                cur = xmlSchematronNextNode(cur);
+                pattern = pattern->next;
             }
-            pattern = pattern->next;
         }
+
+        xmlFree(outcomes);
+        xmlFree(matches);
+        xmlFree(ends);
     }
+    xmlSchematronClearCache(ctxt);
+    if (ret < 0)
+        return(-1);
     return(ctxt->nberrors);
 }
 
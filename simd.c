@@ -0,0 +1,1520 @@
+/*
+ * simd.c: vectorized scanning primitives
+ *
+ * The parser spends most of its time looking for the next byte that
+ * needs special handling in runs of plain ASCII text. The functions in
+ * this module skip over such runs one vector at a time. They only ever
+ * consume whole blocks and stop at the first byte that needs attention
+ * or when less than a block is left, so callers must finish the job
+ * with their scalar code.
+ *
+ * The same approach speeds up the UTF-16 converters, which convert
+ * runs of ASCII characters a vector at a time and leave everything
+ * else, including surrogate pairs, to the scalar code.
+ *
+ * Kernels are selected at runtime by xmlInitSimdInternal. Before the
+ * library is initialized, the baseline kernels of the target
+ * architecture are used.
+ *
+ * See Copyright for the status of this software.
+ */
+
+#define IN_LIBXML
+#include "libxml.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "private/simd.h"
+
+#ifdef XML_SIMD_SSE2
+  #include <emmintrin.h>
+#endif
+#ifdef XML_SIMD_AVX2
+  #include <immintrin.h>
+#endif
+#ifdef XML_SIMD_NEON
+  #include <arm_neon.h>
+#endif
+
+typedef struct {
+    const xmlChar *(*charData)(const xmlChar *cur, const xmlChar *end);
+    const xmlChar *(*attValue)(const xmlChar *cur, const xmlChar *end,
+                               int quote, int space);
+    size_t (*utf16ToAscii)(unsigned char *out, const unsigned char *in,
+                           size_t n, int bigEndian);
+    size_t (*asciiToUtf16)(unsigned char *out, const unsigned char *in,
+                           size_t n, int bigEndian);
+    const xmlChar *(*escape)(const xmlChar *cur, const xmlChar *end,
+                             int nonAscii);
+    const xmlChar *(*utf8CharData)(const xmlChar *cur, const xmlChar *end,
+                                   size_t *nchars);
+    const xmlChar *(*uri)(const xmlChar *cur, const xmlChar *end);
+    const xmlChar *(*asciiSet)(const xmlChar *cur, const xmlChar *end,
+                               const xmlAsciiSet *set);
+    const xmlChar *(*utf8Chars)(const xmlChar *cur, const xmlChar *end,
+                                size_t max, size_t *nchars);
+    size_t (*copyAscii)(unsigned char *out, const unsigned char *in,
+                        size_t n);
+} xmlSimdKernels;
+
+/*
+ * UTF-8 validation with three nibble lookups per byte, following
+ * Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction
+ * Per Byte". Each table maps a nibble to the set of errors it can
+ * take part in. An error is present if all three lookups for a byte
+ * share a bit, except for the expected continuations of three and
+ * four byte sequences which are checked separately.
+ */
+#define UTF8_TOO_SHORT      (1 << 0)
+#define UTF8_TOO_LONG       (1 << 1)
+#define UTF8_OVERLONG_3     (1 << 2)
+#define UTF8_TOO_LARGE      (1 << 3)
+#define UTF8_SURROGATE      (1 << 4)
+#define UTF8_OVERLONG_2     (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4     (1 << 6)
+#define UTF8_TWO_CONTS      (1 << 7)
+#define UTF8_CARRY          (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+#if defined(XML_SIMD_AVX2) || defined(XML_SIMD_NEON)
+
+/* High nibble of the previous byte */
+static const unsigned char xmlUtf8Byte1High[16] = {
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+    UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+    UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+    UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4
+};
+
+/* Low nibble of the previous byte */
+static const unsigned char xmlUtf8Byte1Low[16] = {
+    UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+    UTF8_CARRY | UTF8_OVERLONG_2,
+    UTF8_CARRY,
+    UTF8_CARRY,
+    UTF8_CARRY | UTF8_TOO_LARGE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+    UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000
+};
+
+/* High nibble of the current byte */
+static const unsigned char xmlUtf8Byte2High[16] = {
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE |
+        UTF8_TOO_LARGE,
+    UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT
+};
+
+#endif /* XML_SIMD_AVX2 || XML_SIMD_NEON */
+
+/*
+ * SSE2 lacks byte shuffles, so there is no SSE2 variant. The scalar
+ * code in the parser handles non-ASCII characters one at a time.
+ */
+static const xmlChar *
+xmlScanUtf8CharDataNone(const xmlChar *cur,
+                        const xmlChar *end ATTRIBUTE_UNUSED,
+                        size_t *nchars) {
+    *nchars = 0;
+    return(cur);
+}
+
+/*
+ * Nibble lookups need byte shuffles as well.
+ */
+static const xmlChar *
+xmlScanAsciiSetNone(const xmlChar *cur,
+                    const xmlChar *end ATTRIBUTE_UNUSED,
+                    const xmlAsciiSet *set ATTRIBUTE_UNUSED) {
+    return(cur);
+}
+
+/**
+ * Move the end of a run of validated UTF-8 back to the start of a
+ * trailing sequence which was cut off by the end of the run.
+ *
+ * @param start  start of the run
+ * @param cur  end of the run
+ * @param nchars  number of characters in the run, updated
+ * @returns the new end of the run
+ */
+static XML_INLINE const xmlChar *
+xmlUtf8TrimIncomplete(const xmlChar *start, const xmlChar *cur,
+                      size_t *nchars) {
+    int k;
+
+    for (k = 1; (k <= 3) && (cur - k >= start); k++) {
+        unsigned c = cur[-k];
+
+        if ((c & 0xC0) == 0x80)
+            continue;
+        if ((c >= 0xC0) &&
+            (k < ((c >= 0xF0) ? 4 : (c >= 0xE0) ? 3 : 2))) {
+            *nchars -= 1;
+            return(cur - k);
+        }
+        break;
+    }
+
+    return(cur);
+}
+
+
+/************************************************************************
+ *									*
+ *			SSE2 and AVX2 kernels				*
+ *									*
+ ************************************************************************/
+
+#ifdef XML_SIMD_SSE2
+
+/*
+ * Signed comparison with 0x20 matches both control characters and
+ * bytes >= 0x80, so a single compare covers everything outside of
+ * printable ASCII.
+ */
+static const xmlChar *
+xmlScanCharDataSSE2(const xmlChar *cur, const xmlChar *end) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i tab = _mm_set1_epi8(0x09);
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i rsqb = _mm_set1_epi8(']');
+
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) cur);
+        __m128i m;
+        unsigned mask;
+
+        m = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab),
+                             _mm_cmplt_epi8(v, space));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, lt));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, rsqb));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+static const xmlChar *
+xmlScanAttValueSSE2(const xmlChar *cur, const xmlChar *end, int quote,
+                    int space) {
+    const __m128i low = _mm_set1_epi8(space ? 0x20 : 0x21);
+    const __m128i q = _mm_set1_epi8(quote);
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i amp = _mm_set1_epi8('&');
+
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) cur);
+        __m128i m;
+        unsigned mask;
+
+        m = _mm_cmplt_epi8(v, low);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, q));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, lt));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+static size_t
+xmlUtf16ToAsciiSSE2(unsigned char *out, const unsigned char *in, size_t n,
+                    int bigEndian) {
+    const __m128i high = _mm_set1_epi16((short) 0xFF80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (in + 2 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (in + 2 * i + 16));
+        unsigned long long mask;
+
+        if (bigEndian) {
+            a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+            b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+        }
+
+        /* Two mask bits per code unit */
+        mask = (unsigned) _mm_movemask_epi8(
+                   _mm_cmpeq_epi16(_mm_and_si128(a, high), zero));
+        mask |= (unsigned long long) _mm_movemask_epi8(
+                   _mm_cmpeq_epi16(_mm_and_si128(b, high), zero)) << 16;
+
+        _mm_storeu_si128((__m128i *) (out + i), _mm_packus_epi16(a, b));
+        if (mask != 0xFFFFFFFF)
+            return(i + xmlCountTrailingZeros(~mask) / 2);
+        i += 16;
+    }
+
+    return(i);
+}
+
+static size_t
+xmlAsciiToUtf16SSE2(unsigned char *out, const unsigned char *in, size_t n,
+                    int bigEndian) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        unsigned mask = _mm_movemask_epi8(v);
+        __m128i lo, hi;
+
+        if (bigEndian) {
+            lo = _mm_unpacklo_epi8(zero, v);
+            hi = _mm_unpackhi_epi8(zero, v);
+        } else {
+            lo = _mm_unpacklo_epi8(v, zero);
+            hi = _mm_unpackhi_epi8(v, zero);
+        }
+        _mm_storeu_si128((__m128i *) (out + 2 * i), lo);
+        _mm_storeu_si128((__m128i *) (out + 2 * i + 16), hi);
+        if (mask != 0)
+            return(i + xmlCountTrailingZeros(mask));
+        i += 16;
+    }
+
+    return(i);
+}
+
+static size_t
+xmlCopyAsciiSSE2(unsigned char *out, const unsigned char *in, size_t n) {
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        unsigned mask = _mm_movemask_epi8(v);
+
+        _mm_storeu_si128((__m128i *) (out + i), v);
+        if (mask != 0)
+            return(i + xmlCountTrailingZeros(mask));
+        i += 16;
+    }
+
+    return(i);
+}
+
+/*
+ * The high bit is only tested if non-ASCII characters must be
+ * escaped.
+ */
+static const xmlChar *
+xmlScanEscapeSSE2(const xmlChar *cur, const xmlChar *end, int nonAscii) {
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    const __m128i high = _mm_set1_epi8(nonAscii ? (char) 0x80 : 0);
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i lt = _mm_set1_epi8('<');
+    const __m128i gt = _mm_set1_epi8('>');
+
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) cur);
+        __m128i m;
+        unsigned mask;
+
+        m = _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quot));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, lt));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, gt));
+        m = _mm_or_si128(m, _mm_and_si128(v, high));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+/*
+ * A signed comparison against 0x21 catches both spaces, control
+ * characters and bytes >= 0x80.
+ */
+static const xmlChar *
+xmlScanUriSSE2(const xmlChar *cur, const xmlChar *end) {
+    const __m128i space = _mm_set1_epi8(0x21);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const __m128i quot = _mm_set1_epi8('"');
+    const __m128i amp = _mm_set1_epi8('&');
+
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) cur);
+        __m128i m;
+        unsigned mask;
+
+        m = _mm_cmplt_epi8(v, space);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, del));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quot));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+        mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+/*
+ * Continuations are expected after lead bytes. Comparing the expected
+ * positions with the actual continuation bytes finds structural errors
+ * without a table lookup. Overlong forms and surrogates pass, since
+ * the string functions don't reject them either.
+ */
+static const xmlChar *
+xmlScanUtf8CharsSSE2(const xmlChar *cur, const xmlChar *end, size_t max,
+                     size_t *nchars) {
+    const __m128i contEnd = _mm_set1_epi8(-64);
+    const __m128i lead2 = _mm_set1_epi8(0xC0 - 0x80);
+    const __m128i lead3 = _mm_set1_epi8(0xE0 - 0x80);
+    const __m128i lead4 = _mm_set1_epi8(0xF0 - 0x80);
+    const __m128i invalid = _mm_set1_epi8(0xF8 - 0x80);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i zero = _mm_setzero_si128();
+    const xmlChar *start = cur;
+    __m128i prev = zero;
+    size_t count = 0;
+
+    while (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) cur);
+        __m128i cont, m;
+        size_t n;
+
+        /* Signed less than 0xC0 are the continuation bytes */
+        cont = _mm_cmplt_epi8(v, contEnd);
+
+        if (_mm_movemask_epi8(_mm_or_si128(v, prev)) != 0) {
+            __m128i prev1, prev2, prev3;
+
+            prev1 = _mm_or_si128(_mm_slli_si128(v, 1),
+                                 _mm_srli_si128(prev, 15));
+            prev2 = _mm_or_si128(_mm_slli_si128(v, 2),
+                                 _mm_srli_si128(prev, 14));
+            prev3 = _mm_or_si128(_mm_slli_si128(v, 3),
+                                 _mm_srli_si128(prev, 13));
+
+            /* Saturated subtraction sets the high bit of lead bytes */
+            m = _mm_or_si128(_mm_subs_epu8(prev1, lead2),
+                             _mm_subs_epu8(prev2, lead3));
+            m = _mm_or_si128(m, _mm_subs_epu8(prev3, lead4));
+            m = _mm_xor_si128(m, cont);
+            m = _mm_or_si128(m, _mm_subs_epu8(v, invalid));
+            if (_mm_movemask_epi8(m) != 0)
+                break;
+        }
+
+        /* Count all bytes except continuation bytes */
+        m = _mm_sad_epu8(_mm_andnot_si128(cont, one), zero);
+        n = _mm_cvtsi128_si32(m) + _mm_extract_epi16(m, 4);
+        if (n > max - count)
+            break;
+        count += n;
+        prev = v;
+        cur += 16;
+    }
+
+    *nchars = count;
+    return(xmlUtf8TrimIncomplete(start, cur, nchars));
+}
+
+static const xmlSimdKernels xmlSimdSSE2 = {
+    xmlScanCharDataSSE2,
+    xmlScanAttValueSSE2,
+    xmlUtf16ToAsciiSSE2,
+    xmlAsciiToUtf16SSE2,
+    xmlScanEscapeSSE2,
+    xmlScanUtf8CharDataNone,
+    xmlScanUriSSE2,
+    xmlScanAsciiSetNone,
+    xmlScanUtf8CharsSSE2,
+    xmlCopyAsciiSSE2
+};
+
+#endif /* XML_SIMD_SSE2 */
+
+#ifdef XML_SIMD_AVX2
+
+__attribute__((target("avx2")))
+static const xmlChar *
+xmlScanCharDataAVX2(const xmlChar *cur, const xmlChar *end) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i tab = _mm256_set1_epi8(0x09);
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i rsqb = _mm256_set1_epi8(']');
+
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cur);
+        __m256i m;
+        unsigned mask;
+
+        /* cmpgt with swapped operands is a signed less-than */
+        m = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab),
+                                _mm256_cmpgt_epi8(space, v));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lt));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, rsqb));
+        mask = (unsigned) _mm256_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 32;
+    }
+
+    return(xmlScanCharDataSSE2(cur, end));
+}
+
+__attribute__((target("avx2")))
+static const xmlChar *
+xmlScanAttValueAVX2(const xmlChar *cur, const xmlChar *end, int quote,
+                    int space) {
+    const __m256i low = _mm256_set1_epi8(space ? 0x20 : 0x21);
+    const __m256i q = _mm256_set1_epi8(quote);
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i amp = _mm256_set1_epi8('&');
+
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cur);
+        __m256i m;
+        unsigned mask;
+
+        m = _mm256_cmpgt_epi8(low, v);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, q));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lt));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+        mask = (unsigned) _mm256_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 32;
+    }
+
+    return(xmlScanAttValueSSE2(cur, end, quote, space));
+}
+
+__attribute__((target("avx2")))
+static size_t
+xmlUtf16ToAsciiAVX2(unsigned char *out, const unsigned char *in, size_t n,
+                    int bigEndian) {
+    const __m256i high = _mm256_set1_epi16((short) 0xFF80);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    while (n - i >= 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (in + 2 * i));
+        __m256i b = _mm256_loadu_si256((const __m256i *) (in + 2 * i + 32));
+        unsigned long long mask;
+
+        if (bigEndian) {
+            a = _mm256_or_si256(_mm256_slli_epi16(a, 8),
+                                _mm256_srli_epi16(a, 8));
+            b = _mm256_or_si256(_mm256_slli_epi16(b, 8),
+                                _mm256_srli_epi16(b, 8));
+        }
+
+        mask = (unsigned) _mm256_movemask_epi8(
+                   _mm256_cmpeq_epi16(_mm256_and_si256(a, high), zero));
+        mask |= (unsigned long long) (unsigned) _mm256_movemask_epi8(
+                   _mm256_cmpeq_epi16(_mm256_and_si256(b, high), zero)) << 32;
+
+        /* Packing works per 128-bit lane, restore the order */
+        _mm256_storeu_si256((__m256i *) (out + i),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+        if (mask != 0xFFFFFFFFFFFFFFFFull)
+            return(i + xmlCountTrailingZeros(~mask) / 2);
+        i += 32;
+    }
+
+    return(i + xmlUtf16ToAsciiSSE2(out + i, in + 2 * i, n - i, bigEndian));
+}
+
+__attribute__((target("avx2")))
+static size_t
+xmlAsciiToUtf16AVX2(unsigned char *out, const unsigned char *in, size_t n,
+                    int bigEndian) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    while (n - i >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(v);
+        __m256i lo, hi;
+
+        /* Unpacking works per 128-bit lane, reorder first */
+        v = _mm256_permute4x64_epi64(v, 0xD8);
+        if (bigEndian) {
+            lo = _mm256_unpacklo_epi8(zero, v);
+            hi = _mm256_unpackhi_epi8(zero, v);
+        } else {
+            lo = _mm256_unpacklo_epi8(v, zero);
+            hi = _mm256_unpackhi_epi8(v, zero);
+        }
+        _mm256_storeu_si256((__m256i *) (out + 2 * i), lo);
+        _mm256_storeu_si256((__m256i *) (out + 2 * i + 32), hi);
+        if (mask != 0)
+            return(i + xmlCountTrailingZeros(mask));
+        i += 32;
+    }
+
+    return(i + xmlAsciiToUtf16SSE2(out + 2 * i, in + i, n - i, bigEndian));
+}
+
+__attribute__((target("avx2")))
+static size_t
+xmlCopyAsciiAVX2(unsigned char *out, const unsigned char *in, size_t n) {
+    size_t i = 0;
+
+    while (n - i >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (in + i));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(v);
+
+        _mm256_storeu_si256((__m256i *) (out + i), v);
+        if (mask != 0)
+            return(i + xmlCountTrailingZeros(mask));
+        i += 32;
+    }
+
+    return(i + xmlCopyAsciiSSE2(out + i, in + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static XML_INLINE __m256i
+xmlUtf8LookupAVX2(__m256i table, __m256i nibbles) {
+    return(_mm256_shuffle_epi8(table, nibbles));
+}
+
+/*
+ * Skips character data like xmlScanCharDataAVX2 but also accepts
+ * valid UTF-8 sequences encoding XML characters.
+ */
+__attribute__((target("avx2")))
+static const xmlChar *
+xmlScanUtf8CharDataAVX2(const xmlChar *cur, const xmlChar *end,
+                        size_t *nchars) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i tab = _mm256_set1_epi8(0x09);
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i rsqb = _mm256_set1_epi8(']');
+    const __m256i ef = _mm256_set1_epi8((char) 0xEF);
+    const __m256i bf = _mm256_set1_epi8((char) 0xBF);
+    const __m256i be = _mm256_set1_epi8((char) 0xBE);
+    const __m256i nib = _mm256_set1_epi8(0x0F);
+    const __m256i t1h = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) xmlUtf8Byte1High));
+    const __m256i t1l = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) xmlUtf8Byte1Low));
+    const __m256i t2h = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) xmlUtf8Byte2High));
+    const xmlChar *start = cur;
+    __m256i prev = _mm256_setzero_si256();
+    size_t count = 0;
+
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cur);
+        __m256i sh, prev1, prev2, prev3, m, err;
+        unsigned high;
+
+        /* ASCII bytes that need attention. Bytes >= 0x80 are negative. */
+        m = _mm256_and_si256(
+                _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab),
+                                    _mm256_cmpgt_epi8(space, v)),
+                _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-1)));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lt));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, rsqb));
+        if (_mm256_movemask_epi8(m) != 0)
+            break;
+
+        high = (unsigned) _mm256_movemask_epi8(v);
+        sh = _mm256_permute2x128_si256(prev, v, 0x21);
+        prev1 = _mm256_alignr_epi8(v, sh, 15);
+
+        if ((high != 0) ||
+            ((unsigned) _mm256_movemask_epi8(prev1) != 0)) {
+            __m256i sc;
+
+            prev2 = _mm256_alignr_epi8(v, sh, 14);
+            prev3 = _mm256_alignr_epi8(v, sh, 13);
+
+            sc = _mm256_and_si256(
+                xmlUtf8LookupAVX2(t1h,
+                    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+                xmlUtf8LookupAVX2(t1l, _mm256_and_si256(prev1, nib)));
+            sc = _mm256_and_si256(sc,
+                xmlUtf8LookupAVX2(t2h,
+                    _mm256_and_si256(_mm256_srli_epi16(v, 4), nib)));
+
+            /* Continuations expected after three and four byte leads */
+            m = _mm256_or_si256(
+                _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+                _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80)));
+            m = _mm256_and_si256(m, _mm256_set1_epi8((char) 0x80));
+            err = _mm256_xor_si256(m, sc);
+
+            /* U+FFFE and U+FFFF aren't XML characters */
+            m = _mm256_and_si256(_mm256_cmpeq_epi8(prev2, ef),
+                                 _mm256_cmpeq_epi8(prev1, bf));
+            m = _mm256_and_si256(m, _mm256_or_si256(_mm256_cmpeq_epi8(v, bf),
+                                                    _mm256_cmpeq_epi8(v, be)));
+            err = _mm256_or_si256(err, m);
+
+            if (!_mm256_testz_si256(err, err))
+                break;
+        }
+
+        /* Count all bytes except continuation bytes */
+        m = _mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65));
+        count += __builtin_popcount((unsigned) _mm256_movemask_epi8(m));
+        prev = v;
+        cur += 32;
+    }
+
+    *nchars = count;
+    return(xmlUtf8TrimIncomplete(start, cur, nchars));
+}
+
+__attribute__((target("avx2")))
+static const xmlChar *
+xmlScanEscapeAVX2(const xmlChar *cur, const xmlChar *end, int nonAscii) {
+    const __m256i ctrl = _mm256_set1_epi8(0x1F);
+    const __m256i high = _mm256_set1_epi8(nonAscii ? (char) 0x80 : 0);
+    const __m256i quot = _mm256_set1_epi8('"');
+    const __m256i amp = _mm256_set1_epi8('&');
+    const __m256i lt = _mm256_set1_epi8('<');
+    const __m256i gt = _mm256_set1_epi8('>');
+
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cur);
+        __m256i m;
+        unsigned mask;
+
+        m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl), v);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quot));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, lt));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, gt));
+        m = _mm256_or_si256(m, _mm256_and_si256(v, high));
+        mask = (unsigned) _mm256_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 32;
+    }
+
+    return(xmlScanEscapeSSE2(cur, end, nonAscii));
+}
+
+__attribute__((target("avx2")))
+static const xmlChar *
+xmlScanUriAVX2(const xmlChar *cur, const xmlChar *end) {
+    const __m256i space = _mm256_set1_epi8(0x21);
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    const __m256i quot = _mm256_set1_epi8('"');
+    const __m256i amp = _mm256_set1_epi8('&');
+
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cur);
+        __m256i m;
+        unsigned mask;
+
+        m = _mm256_cmpgt_epi8(space, v);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, del));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quot));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, amp));
+        mask = (unsigned) _mm256_movemask_epi8(m);
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 32;
+    }
+
+    return(xmlScanUriSSE2(cur, end));
+}
+
+/*
+ * Classify bytes with two nibble lookups. The table for the high
+ * nibble maps 0-3 to the bit used in the set for that row, 4-7 to
+ * nothing and 8-15 to bit 7, which is set in every entry of the low
+ * nibble table.
+ */
+__attribute__((target("avx2")))
+static const xmlChar *
+xmlScanAsciiSetAVX2(const xmlChar *cur, const xmlChar *end,
+                    const xmlAsciiSet *set) {
+    const __m128i lo128 = _mm_loadu_si128((const __m128i *) set->lo);
+    const __m128i hi128 = _mm_setr_epi8(1, 2, 4, 8, 0, 0, 0, 0,
+            (char) 0x80, (char) 0x80, (char) 0x80, (char) 0x80,
+            (char) 0x80, (char) 0x80, (char) 0x80, (char) 0x80);
+    const __m128i nibble128 = _mm_set1_epi8(0x0F);
+    const __m128i zero128 = _mm_setzero_si128();
+    const __m256i lo = _mm256_broadcastsi128_si256(lo128);
+    const __m256i hi = _mm256_broadcastsi128_si256(hi128);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cur);
+        __m256i l, h;
+        unsigned mask;
+
+        l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+        h = _mm256_shuffle_epi8(hi,
+                _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        mask = ~(unsigned) _mm256_movemask_epi8(
+                   _mm256_cmpeq_epi8(_mm256_and_si256(l, h), zero));
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 32;
+    }
+
+    if (end - cur >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) cur);
+        __m128i l, h;
+        unsigned mask;
+
+        l = _mm_shuffle_epi8(lo128, _mm_and_si128(v, nibble128));
+        h = _mm_shuffle_epi8(hi128,
+                _mm_and_si128(_mm_srli_epi16(v, 4), nibble128));
+        mask = ~(unsigned) _mm_movemask_epi8(
+                   _mm_cmpeq_epi8(_mm_and_si128(l, h), zero128)) & 0xFFFF;
+        if (mask != 0)
+            return(cur + xmlCountTrailingZeros(mask));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+/*
+ * See xmlScanUtf8CharsSSE2. The bytes preceding each position are
+ * taken from a vector straddling the previous and current block, since
+ * byte shifts only work within 128-bit lanes.
+ */
+__attribute__((target("avx2")))
+static const xmlChar *
+xmlScanUtf8CharsAVX2(const xmlChar *cur, const xmlChar *end, size_t max,
+                     size_t *nchars) {
+    const __m256i contEnd = _mm256_set1_epi8(-64);
+    const __m256i lead2 = _mm256_set1_epi8(0xC0 - 0x80);
+    const __m256i lead3 = _mm256_set1_epi8(0xE0 - 0x80);
+    const __m256i lead4 = _mm256_set1_epi8(0xF0 - 0x80);
+    const __m256i invalid = _mm256_set1_epi8(0xF8 - 0x80);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i zero = _mm256_setzero_si256();
+    const xmlChar *start = cur;
+    __m256i prev = zero;
+    size_t count = 0;
+    size_t rest;
+
+    while (end - cur >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) cur);
+        __m256i cont, m;
+        __m128i s;
+        size_t n;
+
+        /* cmpgt with swapped operands is a signed less-than */
+        cont = _mm256_cmpgt_epi8(contEnd, v);
+
+        if (_mm256_movemask_epi8(_mm256_or_si256(v, prev)) != 0) {
+            __m256i straddle, prev1, prev2, prev3;
+
+            straddle = _mm256_permute2x128_si256(prev, v, 0x21);
+            prev1 = _mm256_alignr_epi8(v, straddle, 15);
+            prev2 = _mm256_alignr_epi8(v, straddle, 14);
+            prev3 = _mm256_alignr_epi8(v, straddle, 13);
+
+            m = _mm256_or_si256(_mm256_subs_epu8(prev1, lead2),
+                                _mm256_subs_epu8(prev2, lead3));
+            m = _mm256_or_si256(m, _mm256_subs_epu8(prev3, lead4));
+            m = _mm256_xor_si256(m, cont);
+            m = _mm256_or_si256(m, _mm256_subs_epu8(v, invalid));
+            if (_mm256_movemask_epi8(m) != 0)
+                break;
+        }
+
+        m = _mm256_sad_epu8(_mm256_andnot_si256(cont, one), zero);
+        s = _mm_add_epi64(_mm256_castsi256_si128(m),
+                          _mm256_extracti128_si256(m, 1));
+        n = _mm_cvtsi128_si32(s) + _mm_extract_epi16(s, 4);
+        if (n > max - count)
+            break;
+        count += n;
+        prev = v;
+        cur += 32;
+    }
+
+    *nchars = count;
+    cur = xmlUtf8TrimIncomplete(start, cur, nchars);
+
+    /* The trimmed end is a character boundary, so start over there */
+    cur = xmlScanUtf8CharsSSE2(cur, end, max - *nchars, &rest);
+    *nchars += rest;
+    return(cur);
+}
+
+static const xmlSimdKernels xmlSimdAVX2 = {
+    xmlScanCharDataAVX2,
+    xmlScanAttValueAVX2,
+    xmlUtf16ToAsciiAVX2,
+    xmlAsciiToUtf16AVX2,
+    xmlScanEscapeAVX2,
+    xmlScanUtf8CharDataAVX2,
+    xmlScanUriAVX2,
+    xmlScanAsciiSetAVX2,
+    xmlScanUtf8CharsAVX2,
+    xmlCopyAsciiAVX2
+};
+
+#endif /* XML_SIMD_AVX2 */
+
+/************************************************************************
+ *									*
+ *			NEON kernels					*
+ *									*
+ ************************************************************************/
+
+#ifdef XML_SIMD_NEON
+
+/*
+ * NEON has no movemask. Narrowing each 16-bit lane by 4 bits yields
+ * a 64-bit value with one nibble per byte.
+ */
+static XML_INLINE unsigned long long
+xmlNeonMask(uint8x16_t m) {
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+
+    return(vget_lane_u64(vreinterpret_u64_u8(n), 0));
+}
+
+static const xmlChar *
+xmlScanCharDataNEON(const xmlChar *cur, const xmlChar *end) {
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t tab = vdupq_n_u8(0x09);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t rsqb = vdupq_n_u8(']');
+
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(cur);
+        uint8x16_t m;
+        unsigned long long mask;
+
+        m = vbicq_u8(vcltq_u8(v, space), vceqq_u8(v, tab));
+        m = vorrq_u8(m, vcgeq_u8(v, high));
+        m = vorrq_u8(m, vceqq_u8(v, lt));
+        m = vorrq_u8(m, vceqq_u8(v, amp));
+        m = vorrq_u8(m, vceqq_u8(v, rsqb));
+        mask = xmlNeonMask(m);
+        if (mask != 0)
+            return(cur + (xmlCountTrailingZeros(mask) >> 2));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+static const xmlChar *
+xmlScanAttValueNEON(const xmlChar *cur, const xmlChar *end, int quote,
+                    int space) {
+    const uint8x16_t low = vdupq_n_u8(space ? 0x20 : 0x21);
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    const uint8x16_t q = vdupq_n_u8(quote);
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t amp = vdupq_n_u8('&');
+
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(cur);
+        uint8x16_t m;
+        unsigned long long mask;
+
+        m = vorrq_u8(vcltq_u8(v, low), vcgeq_u8(v, high));
+        m = vorrq_u8(m, vceqq_u8(v, q));
+        m = vorrq_u8(m, vceqq_u8(v, lt));
+        m = vorrq_u8(m, vceqq_u8(v, amp));
+        mask = xmlNeonMask(m);
+        if (mask != 0)
+            return(cur + (xmlCountTrailingZeros(mask) >> 2));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+static size_t
+xmlUtf16ToAsciiNEON(unsigned char *out, const unsigned char *in, size_t n,
+                    int bigEndian) {
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        /* Deinterleave into low and high bytes */
+        uint8x16x2_t v = vld2q_u8(in + 2 * i);
+        uint8x16_t lo = bigEndian ? v.val[1] : v.val[0];
+        uint8x16_t hi = bigEndian ? v.val[0] : v.val[1];
+        unsigned long long mask;
+
+        mask = xmlNeonMask(vtstq_u8(vorrq_u8(hi, vandq_u8(lo, high)),
+                                    vdupq_n_u8(0xFF)));
+        vst1q_u8(out + i, lo);
+        if (mask != 0)
+            return(i + (xmlCountTrailingZeros(mask) >> 2));
+        i += 16;
+    }
+
+    return(i);
+}
+
+static size_t
+xmlAsciiToUtf16NEON(unsigned char *out, const unsigned char *in, size_t n,
+                    int bigEndian) {
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        uint8x16_t v = vld1q_u8(in + i);
+        unsigned long long mask = xmlNeonMask(vcgeq_u8(v, high));
+        uint8x16x2_t w;
+
+        w.val[0] = bigEndian ? vdupq_n_u8(0) : v;
+        w.val[1] = bigEndian ? v : vdupq_n_u8(0);
+        vst2q_u8(out + 2 * i, w);
+        if (mask != 0)
+            return(i + (xmlCountTrailingZeros(mask) >> 2));
+        i += 16;
+    }
+
+    return(i);
+}
+
+static size_t
+xmlCopyAsciiNEON(unsigned char *out, const unsigned char *in, size_t n) {
+    const uint8x16_t high = vdupq_n_u8(0x80);
+    size_t i = 0;
+
+    while (n - i >= 16) {
+        uint8x16_t v = vld1q_u8(in + i);
+        unsigned long long mask = xmlNeonMask(vcgeq_u8(v, high));
+
+        vst1q_u8(out + i, v);
+        if (mask != 0)
+            return(i + (xmlCountTrailingZeros(mask) >> 2));
+        i += 16;
+    }
+
+    return(i);
+}
+
+/*
+ * Skips character data like xmlScanCharDataNEON but also accepts
+ * valid UTF-8 sequences encoding XML characters.
+ */
+static const xmlChar *
+xmlScanUtf8CharDataNEON(const xmlChar *cur, const xmlChar *end,
+                        size_t *nchars) {
+    const uint8x16_t space = vdupq_n_u8(0x20);
+    const uint8x16_t tab = vdupq_n_u8(0x09);
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t rsqb = vdupq_n_u8(']');
+    const uint8x16_t nib = vdupq_n_u8(0x0F);
+    const uint8x16_t t1h = vld1q_u8(xmlUtf8Byte1High);
+    const uint8x16_t t1l = vld1q_u8(xmlUtf8Byte1Low);
+    const uint8x16_t t2h = vld1q_u8(xmlUtf8Byte2High);
+    const xmlChar *start = cur;
+    uint8x16_t prev = vdupq_n_u8(0);
+    size_t count = 0;
+
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(cur);
+        uint8x16_t prev1, prev2, prev3, m, sc, err;
+
+        m = vbicq_u8(vcltq_u8(v, space), vceqq_u8(v, tab));
+        m = vorrq_u8(m, vceqq_u8(v, lt));
+        m = vorrq_u8(m, vceqq_u8(v, amp));
+        m = vorrq_u8(m, vceqq_u8(v, rsqb));
+        if (vmaxvq_u8(m) != 0)
+            break;
+
+        prev1 = vextq_u8(prev, v, 15);
+        if (vmaxvq_u8(vorrq_u8(v, prev1)) >= 0x80) {
+            prev2 = vextq_u8(prev, v, 14);
+            prev3 = vextq_u8(prev, v, 13);
+
+            sc = vandq_u8(vqtbl1q_u8(t1h, vshrq_n_u8(prev1, 4)),
+                          vqtbl1q_u8(t1l, vandq_u8(prev1, nib)));
+            sc = vandq_u8(sc, vqtbl1q_u8(t2h, vshrq_n_u8(v, 4)));
+
+            /* Continuations expected after three and four byte leads */
+            m = vorrq_u8(vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80)),
+                         vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80)));
+            m = vandq_u8(m, vdupq_n_u8(0x80));
+            err = veorq_u8(m, sc);
+
+            /* U+FFFE and U+FFFF aren't XML characters */
+            m = vandq_u8(vceqq_u8(prev2, vdupq_n_u8(0xEF)),
+                         vceqq_u8(prev1, vdupq_n_u8(0xBF)));
+            m = vandq_u8(m, vcgeq_u8(v, vdupq_n_u8(0xBE)));
+            m = vandq_u8(m, vcleq_u8(v, vdupq_n_u8(0xBF)));
+            err = vorrq_u8(err, m);
+
+            if (vmaxvq_u8(err) != 0)
+                break;
+        }
+
+        /* Count all bytes except continuation bytes */
+        m = vcgtq_s8(vreinterpretq_s8_u8(v), vdupq_n_s8(-65));
+        count += vaddvq_u8(vshrq_n_u8(m, 7));
+        prev = v;
+        cur += 16;
+    }
+
+    *nchars = count;
+    return(xmlUtf8TrimIncomplete(start, cur, nchars));
+}
+
+static const xmlChar *
+xmlScanEscapeNEON(const xmlChar *cur, const xmlChar *end, int nonAscii) {
+    const uint8x16_t ctrl = vdupq_n_u8(0x1F);
+    const uint8x16_t high = vdupq_n_u8(nonAscii ? 0x80 : 0);
+    const uint8x16_t quot = vdupq_n_u8('"');
+    const uint8x16_t amp = vdupq_n_u8('&');
+    const uint8x16_t lt = vdupq_n_u8('<');
+    const uint8x16_t gt = vdupq_n_u8('>');
+
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(cur);
+        uint8x16_t m;
+        unsigned long long mask;
+
+        m = vorrq_u8(vcleq_u8(v, ctrl), vtstq_u8(v, high));
+        m = vorrq_u8(m, vceqq_u8(v, quot));
+        m = vorrq_u8(m, vceqq_u8(v, amp));
+        m = vorrq_u8(m, vceqq_u8(v, lt));
+        m = vorrq_u8(m, vceqq_u8(v, gt));
+        mask = xmlNeonMask(m);
+        if (mask != 0)
+            return(cur + (xmlCountTrailingZeros(mask) >> 2));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+static const xmlChar *
+xmlScanUriNEON(const xmlChar *cur, const xmlChar *end) {
+    const uint8x16_t space = vdupq_n_u8(0x21);
+    const uint8x16_t del = vdupq_n_u8(0x7F);
+    const uint8x16_t quot = vdupq_n_u8('"');
+    const uint8x16_t amp = vdupq_n_u8('&');
+
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(cur);
+        uint8x16_t m;
+        unsigned long long mask;
+
+        m = vorrq_u8(vcltq_u8(v, space), vcgeq_u8(v, del));
+        m = vorrq_u8(m, vceqq_u8(v, quot));
+        m = vorrq_u8(m, vceqq_u8(v, amp));
+        mask = xmlNeonMask(m);
+        if (mask != 0)
+            return(cur + (xmlCountTrailingZeros(mask) >> 2));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+/*
+ * See xmlScanAsciiSetAVX2 for the lookup tables.
+ */
+static const xmlChar *
+xmlScanAsciiSetNEON(const xmlChar *cur, const xmlChar *end,
+                    const xmlAsciiSet *set) {
+    static const unsigned char hiTable[16] = {
+        1, 2, 4, 8, 0, 0, 0, 0,
+        0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+    };
+    const uint8x16_t lo = vld1q_u8(set->lo);
+    const uint8x16_t hi = vld1q_u8(hiTable);
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(cur);
+        uint8x16_t l, h;
+        unsigned long long mask;
+
+        l = vqtbl1q_u8(lo, vandq_u8(v, nibble));
+        h = vqtbl1q_u8(hi, vshrq_n_u8(v, 4));
+        mask = xmlNeonMask(vtstq_u8(l, h));
+        if (mask != 0)
+            return(cur + (xmlCountTrailingZeros(mask) >> 2));
+        cur += 16;
+    }
+
+    return(cur);
+}
+
+/*
+ * See xmlScanUtf8CharsSSE2.
+ */
+static const xmlChar *
+xmlScanUtf8CharsNEON(const xmlChar *cur, const xmlChar *end, size_t max,
+                     size_t *nchars) {
+    const int8x16_t contEnd = vdupq_n_s8(-64);
+    const uint8x16_t lead2 = vdupq_n_u8(0xC0 - 0x80);
+    const uint8x16_t lead3 = vdupq_n_u8(0xE0 - 0x80);
+    const uint8x16_t lead4 = vdupq_n_u8(0xF0 - 0x80);
+    const uint8x16_t invalid = vdupq_n_u8(0xF8 - 0x80);
+    const xmlChar *start = cur;
+    uint8x16_t prev = vdupq_n_u8(0);
+    size_t count = 0;
+
+    while (end - cur >= 16) {
+        uint8x16_t v = vld1q_u8(cur);
+        uint8x16_t cont, m;
+        size_t n;
+
+        cont = vcltq_s8(vreinterpretq_s8_u8(v), contEnd);
+
+        if (vmaxvq_u8(vorrq_u8(v, prev)) >= 0x80) {
+            uint8x16_t prev1, prev2, prev3;
+
+            prev1 = vextq_u8(prev, v, 15);
+            prev2 = vextq_u8(prev, v, 14);
+            prev3 = vextq_u8(prev, v, 13);
+
+            m = vorrq_u8(vqsubq_u8(prev1, lead2), vqsubq_u8(prev2, lead3));
+            m = vorrq_u8(m, vqsubq_u8(prev3, lead4));
+            m = veorq_u8(m, cont);
+            m = vorrq_u8(m, vqsubq_u8(v, invalid));
+            if (vmaxvq_u8(m) >= 0x80)
+                break;
+        }
+
+        n = 16 - vaddvq_u8(vshrq_n_u8(cont, 7));
+        if (n > max - count)
+            break;
+        count += n;
+        prev = v;
+        cur += 16;
+    }
+
+    *nchars = count;
+    return(xmlUtf8TrimIncomplete(start, cur, nchars));
+}
+
+static const xmlSimdKernels xmlSimdNEON = {
+    xmlScanCharDataNEON,
+    xmlScanAttValueNEON,
+    xmlUtf16ToAsciiNEON,
+    xmlAsciiToUtf16NEON,
+    xmlScanEscapeNEON,
+    xmlScanUtf8CharDataNEON,
+    xmlScanUriNEON,
+    xmlScanAsciiSetNEON,
+    xmlScanUtf8CharsNEON,
+    xmlCopyAsciiNEON
+};
+
+#endif /* XML_SIMD_NEON */
+
+/************************************************************************
+ *									*
+ *			Dispatch					*
+ *									*
+ ************************************************************************/
+
+static const xmlChar *
+xmlScanCharDataNone(const xmlChar *cur,
+                    const xmlChar *end ATTRIBUTE_UNUSED) {
+    return(cur);
+}
+
+static const xmlChar *
+xmlScanAttValueNone(const xmlChar *cur,
+                    const xmlChar *end ATTRIBUTE_UNUSED,
+                    int quote ATTRIBUTE_UNUSED,
+                    int space ATTRIBUTE_UNUSED) {
+    return(cur);
+}
+
+static const xmlChar *
+xmlScanEscapeNone(const xmlChar *cur,
+                  const xmlChar *end ATTRIBUTE_UNUSED,
+                  int nonAscii ATTRIBUTE_UNUSED) {
+    return(cur);
+}
+
+static size_t
+xmlConvertNone(unsigned char *out ATTRIBUTE_UNUSED,
+               const unsigned char *in ATTRIBUTE_UNUSED,
+               size_t n ATTRIBUTE_UNUSED,
+               int bigEndian ATTRIBUTE_UNUSED) {
+    return(0);
+}
+
+static const xmlChar *
+xmlScanUtf8CharsNone(const xmlChar *cur,
+                     const xmlChar *end ATTRIBUTE_UNUSED,
+                     size_t max ATTRIBUTE_UNUSED,
+                     size_t *nchars) {
+    *nchars = 0;
+    return(cur);
+}
+
+static size_t
+xmlCopyAsciiNone(unsigned char *out ATTRIBUTE_UNUSED,
+                 const unsigned char *in ATTRIBUTE_UNUSED,
+                 size_t n ATTRIBUTE_UNUSED) {
+    return(0);
+}
+
+static const xmlSimdKernels xmlSimdNone = {
+    xmlScanCharDataNone,
+    xmlScanAttValueNone,
+    xmlConvertNone,
+    xmlConvertNone,
+    xmlScanEscapeNone,
+    xmlScanUtf8CharDataNone,
+    xmlScanCharDataNone,
+    xmlScanAsciiSetNone,
+    xmlScanUtf8CharsNone,
+    xmlCopyAsciiNone
+};
+
+#if defined(XML_SIMD_SSE2)
+static const xmlSimdKernels *xmlSimd = &xmlSimdSSE2;
+#elif defined(XML_SIMD_NEON)
+static const xmlSimdKernels *xmlSimd = &xmlSimdNEON;
+#else
+static const xmlSimdKernels *xmlSimd = &xmlSimdNone;
+#endif
+
+/**
+ * Select the best kernels for the CPU we're running on.
+ *
+ * Setting the environment variable XML_SIMD to "none" disables the
+ * vectorized kernels, "sse2" limits x86 CPUs to SSE2. This is mainly
+ * useful to test the fallback code.
+ */
+void
+xmlInitSimdInternal(void) {
+    const char *env = getenv("XML_SIMD");
+
+    if ((env != NULL) && (strcmp(env, "none") == 0)) {
+        xmlSimd = &xmlSimdNone;
+        return;
+    }
+
+#ifdef XML_SIMD_AVX2
+    if ((env != NULL) && (strcmp(env, "sse2") == 0))
+        return;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        xmlSimd = &xmlSimdAVX2;
+#endif
+}
+
+/**
+ * Skip plain character data. Stops at the first byte which isn't a
+ * printable ASCII character or tab, or which is one of '<', '&' or
+ * ']'. May also stop early if less than a vector is left.
+ *
+ * @param cur  start of the data
+ * @param end  end of the data
+ * @returns a pointer to the first byte that wasn't skipped
+ */
+const xmlChar *
+xmlScanCharData(const xmlChar *cur, const xmlChar *end) {
+    return(xmlSimd->charData(cur, end));
+}
+
+/**
+ * Skip plain characters in an attribute value. Stops at the first
+ * byte which isn't printable ASCII, or which is the quote character,
+ * '<' or '&'. Spaces are only skipped if `space` is set, so callers
+ * normalizing whitespace see every space character.
+ *
+ * @param cur  start of the data
+ * @param end  end of the data
+ * @param quote  the quote character
+ * @param space  whether to skip spaces
+ * @returns a pointer to the first byte that wasn't skipped
+ */
+const xmlChar *
+xmlScanAttValue(const xmlChar *cur, const xmlChar *end, int quote,
+                int space) {
+    return(xmlSimd->attValue(cur, end, quote, space));
+}
+
+/**
+ * Convert ASCII characters from UTF-16 to UTF-8. Stops at the first
+ * code unit which isn't ASCII. May also stop early if less than a
+ * vector is left.
+ *
+ * Bytes after the converted characters may be overwritten, up to
+ * `n` bytes in total.
+ *
+ * @param out  output buffer with room for `n` bytes
+ * @param in  UTF-16 input with `n` code units
+ * @param n  number of code units
+ * @param bigEndian  whether the input is big endian
+ * @returns the number of characters converted
+ */
+size_t
+xmlUtf16ToAscii(unsigned char *out, const unsigned char *in, size_t n,
+                int bigEndian) {
+    return(xmlSimd->utf16ToAscii(out, in, n, bigEndian));
+}
+
+/**
+ * Convert ASCII characters from UTF-8 to UTF-16. Stops at the first
+ * byte which isn't ASCII. May also stop early if less than a vector
+ * is left.
+ *
+ * Bytes after the converted characters may be overwritten, up to
+ * `2 * n` bytes in total.
+ *
+ * @param out  output buffer with room for `2 * n` bytes
+ * @param in  UTF-8 input with `n` bytes
+ * @param n  number of bytes
+ * @param bigEndian  whether to produce big endian output
+ * @returns the number of characters converted
+ */
+size_t
+xmlAsciiToUtf16(unsigned char *out, const unsigned char *in, size_t n,
+                int bigEndian) {
+    return(xmlSimd->asciiToUtf16(out, in, n, bigEndian));
+}
+
+/**
+ * Copy ASCII bytes from `in` to `out`. Stops at the first byte which
+ * isn't ASCII. May also stop early if less than a vector is left.
+ *
+ * Bytes after the copied characters may be overwritten, up to `n`
+ * bytes in total.
+ *
+ * @param out  output buffer with room for `n` bytes
+ * @param in  input with `n` bytes
+ * @param n  number of bytes
+ * @returns the number of bytes copied
+ */
+size_t
+xmlCopyAscii(unsigned char *out, const unsigned char *in, size_t n) {
+    return(xmlSimd->copyAscii(out, in, n));
+}
+
+/**
+ * Skip text which doesn't need escaping on output. Stops at the first
+ * control character and at '"', '&', '<' or '>'. If `nonAscii` is set,
+ * also stops at bytes >= 0x80. May also stop early if less than a
+ * vector is left.
+ *
+ * @param cur  start of the text
+ * @param end  end of the text
+ * @param nonAscii  whether non-ASCII characters are escaped
+ * @returns a pointer to the first byte that wasn't skipped
+ */
+const xmlChar *
+xmlScanEscape(const xmlChar *cur, const xmlChar *end, int nonAscii) {
+    return(xmlSimd->escape(cur, end, nonAscii));
+}
+
+/**
+ * Skip character data containing non-ASCII characters. Stops at the
+ * first byte which is a control character other than tab or one of
+ * '<', '&' or ']', and at the first invalid or incomplete UTF-8
+ * sequence or sequence which doesn't encode an XML character. May
+ * also stop early if less than a vector is left or if the CPU has no
+ * suitable instructions.
+ *
+ * @param cur  start of the data
+ * @param end  end of the data
+ * @param nchars  set to the number of characters skipped
+ * @returns a pointer to the first byte that wasn't skipped
+ */
+const xmlChar *
+xmlScanUtf8CharData(const xmlChar *cur, const xmlChar *end, size_t *nchars) {
+    return(xmlSimd->utf8CharData(cur, end, nchars));
+}
+
+/**
+ * Skip URI characters which don't need escaping on HTML output. Stops
+ * at the first byte which isn't printable ASCII, and at '"' or '&'.
+ * May also stop early if less than a vector is left.
+ *
+ * @param cur  start of the URI
+ * @param end  end of the URI
+ * @returns a pointer to the first byte that wasn't skipped
+ */
+const xmlChar *
+xmlScanUri(const xmlChar *cur, const xmlChar *end) {
+    return(xmlSimd->uri(cur, end));
+}
+
+/**
+ * Skip bytes which aren't in a set of ASCII characters. Stops at the
+ * first byte in the set and at bytes >= 0x80. May also stop early if
+ * less than a vector is left or if the CPU has no suitable
+ * instructions.
+ *
+ * @param cur  start of the data
+ * @param end  end of the data
+ * @param set  the set of characters to stop at
+ * @returns a pointer to the first byte that wasn't skipped
+ */
+const xmlChar *
+xmlScanAsciiSet(const xmlChar *cur, const xmlChar *end,
+                const xmlAsciiSet *set) {
+    return(xmlSimd->asciiSet(cur, end, set));
+}
+
+/**
+ * Skip well-formed UTF-8 sequences, counting characters. Stops before
+ * more than `max` characters would be skipped and at the first
+ * malformed or incomplete sequence. May also stop early if less than a
+ * vector is left.
+ *
+ * Only the structure of sequences is checked, so the result agrees
+ * with the lenient scalar loops of the string functions.
+ *
+ * @param cur  start of the string
+ * @param end  end of the string
+ * @param max  maximum number of characters to skip
+ * @param nchars  set to the number of characters skipped
+ * @returns a pointer to the first byte that wasn't skipped
+ */
+const xmlChar *
+xmlScanUtf8Chars(const xmlChar *cur, const xmlChar *end, size_t max,
+                 size_t *nchars) {
+    return(xmlSimd->utf8Chars(cur, end, max, nchars));
+}
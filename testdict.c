@@ -2,6 +2,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <libxml/parser.h>
 #include <libxml/dict.h>
 
@@ -395,6 +396,170 @@ test_dict(xmlDict *dict) {
     return(ret);
 }
 
+/*
+ * Test a frozen dictionary shared as sub-dictionary
+ */
+static int
+test_frozen_dict(xmlDict *parent) {
+    int i, j;
+    int ret = 0;
+    xmlDictPtr dict[2];
+    int size;
+
+    size = xmlDictSize(parent);
+    if (xmlDictFreeze(parent) != 0) {
+        fprintf(stderr, "Failed to freeze dictionary\n");
+        return(1);
+    }
+
+    for (i = 0;i < NB_STRINGS_MAX;i++) {
+        if (xmlDictLookup(parent, strings1[i], -1) != test1[i]) {
+	    fprintf(stderr, "Failed frozen lookup for '%s'\n", strings1[i]);
+	    ret = 1;
+	    nbErrors++;
+	}
+        if (xmlDictLookup(parent, strings2[i], -1) != NULL) {
+	    fprintf(stderr, "Added '%s' to frozen dictionary\n",
+                    strings2[i]);
+	    ret = 1;
+	    nbErrors++;
+	}
+    }
+    if (xmlDictSize(parent) != size) {
+        fprintf(stderr, "Frozen dictionary changed size\n");
+        ret = 1;
+        nbErrors++;
+    }
+
+    for (j = 0; j < 2; j++) {
+        dict[j] = xmlDictCreateSub(parent);
+        if (dict[j] == NULL) {
+            fprintf(stderr, "Out of memory while creating sub-dictionary\n");
+            exit(1);
+        }
+    }
+
+    for (i = 0;i < NB_STRINGS_MAX;i++) {
+        for (j = 0; j < 2; j++) {
+            const xmlChar *tmp;
+
+            if (xmlDictLookup(dict[j], strings1[i], -1) != test1[i]) {
+                fprintf(stderr, "Failed sub lookup for '%s'\n",
+                        strings1[i]);
+                ret = 1;
+                nbErrors++;
+            }
+            tmp = xmlDictLookup(dict[j], strings2[i], -1);
+            if ((tmp == NULL) || (xmlDictOwns(parent, tmp))) {
+                fprintf(stderr, "Failed sub insertion for '%s'\n",
+                        strings2[i]);
+                ret = 1;
+                nbErrors++;
+            }
+        }
+    }
+
+    for (j = 0; j < 2; j++)
+        xmlDictFree(dict[j]);
+
+    return(ret);
+}
+
+/*
+ * Test saving and loading dictionary snapshots
+ */
+static int
+test_dict_snapshot(xmlDict *parent) {
+    xmlDictPtr dict, conc;
+    unsigned char *mem;
+    size_t size;
+    int i;
+    int ret = 0;
+
+    if (xmlDictSave(parent, &mem, &size) != 0) {
+        fprintf(stderr, "Failed to save dictionary\n");
+        return(1);
+    }
+
+    dict = xmlDictLoad(mem, size);
+    if (dict == NULL) {
+        fprintf(stderr, "Failed to load dictionary\n");
+        xmlFree(mem);
+        return(1);
+    }
+    if (xmlDictSize(dict) != xmlDictSize(parent)) {
+        fprintf(stderr, "Loaded dictionary has wrong size\n");
+        ret = 1;
+        nbErrors++;
+    }
+    for (i = 0; i < NB_STRINGS_MAX; i++) {
+        const xmlChar *tmp = xmlDictExists(dict, strings1[i], -1);
+
+        if ((tmp == NULL) || (!xmlStrEqual(tmp, strings1[i]))) {
+            fprintf(stderr, "Missing '%s' in loaded dictionary\n",
+                    strings1[i]);
+            ret = 1;
+            nbErrors++;
+        }
+        if (xmlDictExists(dict, strings2[i], -1) != NULL) {
+            fprintf(stderr, "Unexpected '%s' in loaded dictionary\n",
+                    strings2[i]);
+            ret = 1;
+            nbErrors++;
+        }
+    }
+    xmlDictFree(dict);
+
+    /* Malformed snapshots */
+    if ((xmlDictLoad(mem, size - 1) != NULL) ||
+        (xmlDictLoad(mem, 8) != NULL)) {
+        fprintf(stderr, "Loaded truncated dictionary\n");
+        ret = 1;
+        nbErrors++;
+    }
+    mem[8] += 1;
+    if (xmlDictLoad(mem, size) != NULL) {
+        fprintf(stderr, "Loaded dictionary with wrong count\n");
+        ret = 1;
+        nbErrors++;
+    }
+    mem[8] -= 1;
+    mem[0] = 'x';
+    if (xmlDictLoad(mem, size) != NULL) {
+        fprintf(stderr, "Loaded dictionary with wrong magic\n");
+        ret = 1;
+        nbErrors++;
+    }
+    xmlFree(mem);
+
+    /* Concurrent dictionaries */
+    conc = xmlDictCreateConcurrent();
+    if (conc == NULL) {
+        fprintf(stderr, "Out of memory while creating dictionary\n");
+        exit(1);
+    }
+    for (i = 0; i < 1000; i++)
+        xmlDictLookup(conc, strings2[i], -1);
+    if (xmlDictSave(conc, &mem, &size) != 0) {
+        fprintf(stderr, "Failed to save concurrent dictionary\n");
+        ret = 1;
+        nbErrors++;
+    } else {
+        dict = xmlDictLoad(mem, size);
+        if ((dict == NULL) || (xmlDictSize(dict) != xmlDictSize(conc)) ||
+            (xmlDictExists(dict, strings2[999], -1) == NULL)) {
+            fprintf(stderr, "Failed to load concurrent dictionary\n");
+            ret = 1;
+            nbErrors++;
+        }
+        xmlDictFree(dict);
+        xmlFree(mem);
+    }
+    xmlDictFree(conc);
+
+    return(ret);
+}
+
 static int
 testall_dict(void) {
     xmlDictPtr dict;
@@ -426,6 +591,12 @@ testall_dict(void) {
     if (test_subdict(dict) != 0) {
         ret = 1;
     }
+    if (test_dict_snapshot(dict) != 0) {
+        ret = 1;
+    }
+    if (test_frozen_dict(dict) != 0) {
+        ret = 1;
+    }
     xmlDictFree(dict);
 
     clean_strings();
@@ -795,14 +966,133 @@ testall_hash(void) {
 }
 
 
+/**** benchmark ****/
+
+#define BENCH_NAMES 4096
+#define BENCH_ROUNDS 200
+
+static double
+bench_rate(clock_t start, size_t ops) {
+    double secs = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    if (secs <= 0)
+        secs = 1e-9;
+    return((double) ops / secs);
+}
+
+static int
+bench_size(size_t len) {
+    xmlChar **names, **misses;
+    xmlDictPtr dict;
+    xmlHashTablePtr hash;
+    clock_t start;
+    size_t i, j, k;
+    double dictRate, hashRate, missRate;
+    int ret = 0;
+
+    names = xmlMalloc(BENCH_NAMES * sizeof(names[0]));
+    misses = xmlMalloc(BENCH_NAMES * sizeof(misses[0]));
+    dict = xmlDictCreate();
+    hash = xmlHashCreate(0);
+    if ((names == NULL) || (misses == NULL) ||
+        (dict == NULL) || (hash == NULL)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; i < BENCH_NAMES; i++) {
+        names[i] = xmlMalloc(len + 1);
+        for (j = 0; j < len; j++)
+            names[i][j] = "abcdefghijklmnopqrstuvwxyz-_.0123"[
+                                (i * 7 + j * 13 + i / 5) % 33];
+        /* Make names unique */
+        for (j = 0, k = i; j < len && k > 0; j++, k /= 26)
+            names[i][j] = 'a' + k % 26;
+        names[i][len] = 0;
+        misses[i] = xmlStrdup(names[i]);
+        if (misses[i] == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        /* Not part of the alphabet above */
+        misses[i][len - 1] = '#';
+        if ((xmlDictLookup(dict, names[i], len) == NULL) ||
+            (xmlHashAddEntry(hash, names[i], names[i]) < -1)) {
+            ret = 1;
+            break;
+        }
+    }
+
+    start = clock();
+    for (k = 0; k < BENCH_ROUNDS; k++) {
+        for (i = 0; i < BENCH_NAMES; i++) {
+            if (xmlDictLookup(dict, names[i], -1) == NULL)
+                ret = 1;
+        }
+    }
+    dictRate = bench_rate(start, (size_t) BENCH_ROUNDS * BENCH_NAMES);
+
+    start = clock();
+    for (k = 0; k < BENCH_ROUNDS; k++) {
+        for (i = 0; i < BENCH_NAMES; i++) {
+            if (xmlHashLookup(hash, names[i]) == NULL)
+                ret = 1;
+        }
+    }
+    hashRate = bench_rate(start, (size_t) BENCH_ROUNDS * BENCH_NAMES);
+
+    start = clock();
+    for (k = 0; k < BENCH_ROUNDS; k++) {
+        for (i = 0; i < BENCH_NAMES; i++) {
+            if (xmlHashLookup(hash, misses[i]) != NULL)
+                ret = 1;
+        }
+    }
+    missRate = bench_rate(start, (size_t) BENCH_ROUNDS * BENCH_NAMES);
+
+    printf("%4d byte names: %12.0f dict lookups/s %12.0f hash lookups/s "
+           "%12.0f hash misses/s\n",
+           (int) len, dictRate, hashRate, missRate);
+
+    xmlHashFree(hash, NULL);
+    xmlDictFree(dict);
+    for (i = 0; i < BENCH_NAMES; i++) {
+        xmlFree(names[i]);
+        xmlFree(misses[i]);
+    }
+    xmlFree(names);
+    xmlFree(misses);
+
+    return(ret);
+}
+
+static int
+bench_all(void) {
+    static const size_t sizes[] = { 6, 24, 96 };
+    size_t i;
+    int ret = 0;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        ret |= bench_size(sizes[i]);
+
+    return(ret);
+}
+
 /**** main ****/
 
 int
-main(void) {
+main(int argc, char **argv) {
     int ret = 0;
 
     LIBXML_TEST_VERSION
 
+    /* Benchmark lookup speed by name length */
+    if ((argc > 1) && (strcmp(argv[1], "--bench") == 0)) {
+        ret = bench_all();
+        xmlCleanupParser();
+        return(ret);
+    }
+
     if (testall_dict() != 0) {
         fprintf(stderr, "dictionary tests failed\n");
         ret = 1;
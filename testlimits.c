@@ -25,6 +25,12 @@
 #ifdef LIBXML_READER_ENABLED
 #include <libxml/xmlreader.h>
 #endif
+#ifdef LIBXML_XPATH_ENABLED
+#include <libxml/xpath.h>
+#endif
+#ifdef LIBXML_SCHEMAS_ENABLED
+#include <libxml/xmlschemas.h>
+#endif
 
 static int verbose = 0;
 static int tests_quiet = 0;
@@ -1228,6 +1234,236 @@ runcrazy(void) {
     return(ret);
 }
 
+static void
+ignoreError(void *ctx ATTRIBUTE_UNUSED, const xmlError *error ATTRIBUTE_UNUSED) {
+}
+
+static int
+runmembudget(void) {
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    const xmlError *error;
+    char *buf;
+    size_t len = 0, bufSize;
+    int i, ret = 0;
+
+    if (tests_quiet == 0)
+	printf("## Memory budgets\n");
+
+    bufSize = 20 + 2000 * 30;
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        return(1);
+    len += snprintf(buf + len, bufSize - len, "<doc>");
+    for (i = 0; i < 2000; i++)
+        len += snprintf(buf + len, bufSize - len, "<e a='%d'>text</e>", i);
+    len += snprintf(buf + len, bufSize - len, "</doc>");
+
+    nb_tests++;
+    ctxt = xmlNewParserCtxt();
+    if (xmlCtxtSetMaxMemory(ctxt, 10 * 1000 * 1000) < 0) {
+        fprintf(stderr, "Failed to set memory budget\n");
+        ret = 1;
+        goto done;
+    }
+    doc = xmlCtxtReadMemory(ctxt, buf, len, NULL, NULL, XML_PARSE_NOERROR);
+    if ((doc == NULL) || (xmlCtxtGetMemoryUsed(ctxt) == 0)) {
+        fprintf(stderr, "Failed to parse within memory budget\n");
+        ret = 1;
+    }
+
+    nb_tests++;
+    xmlCtxtSetMaxMemory(ctxt, 10 * 1000);
+    if (xmlCtxtReadMemory(ctxt, buf, len, NULL, NULL,
+                          XML_PARSE_NOERROR) != NULL) {
+        fprintf(stderr, "Memory budget not enforced\n");
+        ret = 1;
+    }
+    error = xmlCtxtGetLastError(ctxt);
+    if ((error == NULL) || (error->code != XML_ERR_RESOURCE_LIMIT)) {
+        fprintf(stderr, "Wrong error for exceeded memory budget\n");
+        ret = 1;
+    }
+    if (xmlCtxtGetMemoryUsed(ctxt) > 10 * 1000) {
+        fprintf(stderr, "Memory budget overrun\n");
+        ret = 1;
+    }
+
+#ifdef LIBXML_XPATH_ENABLED
+    if (doc != NULL) {
+        xmlXPathContextPtr xpctxt;
+        xmlXPathObjectPtr res;
+
+        nb_tests++;
+        xpctxt = xmlXPathNewContext(doc);
+        xmlXPathContextSetMaxMemory(xpctxt, 1000);
+        res = xmlXPathEval(BAD_CAST "//e[@a > 10]", xpctxt);
+        if ((res != NULL) ||
+            (xpctxt->lastError.code != XML_ERR_RESOURCE_LIMIT)) {
+            fprintf(stderr, "XPath memory budget not enforced\n");
+            ret = 1;
+        }
+        xmlXPathFreeObject(res);
+
+        xmlXPathContextSetMaxMemory(xpctxt, 1000 * 1000);
+        res = xmlXPathEval(BAD_CAST "//e[@a > 10]", xpctxt);
+        if ((res == NULL) || (res->nodesetval == NULL) ||
+            (res->nodesetval->nodeNr != 1989) ||
+            (xmlXPathContextGetMemoryUsed(xpctxt) == 0)) {
+            fprintf(stderr, "XPath failed within memory budget\n");
+            ret = 1;
+        }
+        xmlXPathFreeObject(res);
+        xmlXPathFreeContext(xpctxt);
+    }
+#endif
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+    if (doc != NULL) {
+        static const char schemaStr[] =
+            "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>"
+            " <xs:element name='doc'><xs:complexType><xs:sequence>"
+            "  <xs:element name='e' maxOccurs='unbounded'><xs:complexType>"
+            "   <xs:simpleContent><xs:extension base='xs:string'>"
+            "    <xs:attribute name='a' type='xs:int'/>"
+            "   </xs:extension></xs:simpleContent>"
+            "  </xs:complexType></xs:element>"
+            " </xs:sequence></xs:complexType></xs:element>"
+            "</xs:schema>";
+        xmlSchemaParserCtxtPtr pctxt;
+        xmlSchemaPtr schema;
+        xmlSchemaValidCtxtPtr vctxt;
+
+        nb_tests++;
+        pctxt = xmlSchemaNewMemParserCtxt(schemaStr, sizeof(schemaStr) - 1);
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+        vctxt = xmlSchemaNewValidCtxt(schema);
+        xmlSchemaSetValidStructuredErrors(vctxt, ignoreError, NULL);
+
+        xmlSchemaValidCtxtSetMaxMemory(vctxt, 100);
+        if (xmlSchemaValidateDoc(vctxt, doc) != -1) {
+            fprintf(stderr, "Schema memory budget not enforced\n");
+            ret = 1;
+        }
+
+        xmlSchemaValidCtxtSetMaxMemory(vctxt, 1000 * 1000);
+        if ((xmlSchemaValidateDoc(vctxt, doc) != 0) ||
+            (xmlSchemaValidCtxtGetMemoryUsed(vctxt) == 0)) {
+            fprintf(stderr, "Schema validation failed within memory "
+                    "budget\n");
+            ret = 1;
+        }
+
+        xmlSchemaFreeValidCtxt(vctxt);
+        xmlSchemaFree(schema);
+    }
+#endif
+
+    xmlFreeDoc(doc);
+
+done:
+    xmlFreeParserCtxt(ctxt);
+    free(buf);
+    if (ret)
+        nb_errors++;
+    return(ret);
+}
+
+static int
+runtimelimits(void) {
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    const xmlError *error;
+    char *buf;
+    size_t len = 0, bufSize;
+    int i, ret = 0;
+
+    if (tests_quiet == 0)
+	printf("## Time limits and cancellation\n");
+
+    bufSize = 20 + 200000 * 30;
+    buf = malloc(bufSize);
+    if (buf == NULL)
+        return(1);
+    len += snprintf(buf + len, bufSize - len, "<doc>");
+    for (i = 0; i < 200000; i++)
+        len += snprintf(buf + len, bufSize - len, "<e a='%d'>text</e>", i);
+    len += snprintf(buf + len, bufSize - len, "</doc>");
+
+    nb_tests++;
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetTimeLimit(ctxt, 1);
+    if (xmlCtxtReadMemory(ctxt, buf, len, NULL, NULL,
+                          XML_PARSE_NOERROR) != NULL) {
+        fprintf(stderr, "Parser time limit not enforced\n");
+        ret = 1;
+    }
+    error = xmlCtxtGetLastError(ctxt);
+    if ((error == NULL) || (error->code != XML_ERR_RESOURCE_LIMIT)) {
+        fprintf(stderr, "Wrong error for exceeded parser time limit\n");
+        ret = 1;
+    }
+
+    nb_tests++;
+    xmlCtxtSetTimeLimit(ctxt, 60 * 1000);
+    doc = xmlCtxtReadMemory(ctxt, buf, len / 100, NULL, NULL,
+                            XML_PARSE_NOERROR | XML_PARSE_RECOVER);
+    if (doc == NULL) {
+        fprintf(stderr, "Failed to parse within time limit\n");
+        ret = 1;
+    }
+    xmlFreeParserCtxt(ctxt);
+
+#ifdef LIBXML_XPATH_ENABLED
+    if (doc != NULL) {
+        xmlXPathContextPtr xpctxt;
+        xmlXPathObjectPtr res;
+        volatile int cancel = 0;
+
+        nb_tests++;
+        xpctxt = xmlXPathNewContext(doc);
+        xmlXPathSetErrorHandler(xpctxt, ignoreError, NULL);
+        xmlXPathContextSetTimeLimit(xpctxt, 1);
+        res = xmlXPathEval(BAD_CAST "count(//e[count(//e) > 0])", xpctxt);
+        if ((res != NULL) ||
+            (xpctxt->lastError.code !=
+             XML_XPATH_EXPRESSION_OK + XPATH_TIME_LIMIT_EXCEEDED)) {
+            fprintf(stderr, "XPath time limit not enforced\n");
+            ret = 1;
+        }
+        xmlXPathFreeObject(res);
+        xmlXPathContextSetTimeLimit(xpctxt, 0);
+
+        nb_tests++;
+        xmlXPathContextSetCancelFlag(xpctxt, &cancel);
+        cancel = 1;
+        res = xmlXPathEval(BAD_CAST "count(//e)", xpctxt);
+        if ((res != NULL) ||
+            (xpctxt->lastError.code !=
+             XML_XPATH_EXPRESSION_OK + XPATH_CANCELLED)) {
+            fprintf(stderr, "XPath cancellation not handled\n");
+            ret = 1;
+        }
+        xmlXPathFreeObject(res);
+
+        cancel = 0;
+        res = xmlXPathEval(BAD_CAST "count(//e)", xpctxt);
+        if ((res == NULL) || (res->floatval <= 0)) {
+            fprintf(stderr, "XPath failed after cancellation\n");
+            ret = 1;
+        }
+        xmlXPathFreeObject(res);
+        xmlXPathFreeContext(xpctxt);
+    }
+#endif
+
+    xmlFreeDoc(doc);
+    free(buf);
+    if (ret)
+        nb_errors++;
+    return(ret);
+}
 
 int
 main(int argc ATTRIBUTE_UNUSED, char **argv ATTRIBUTE_UNUSED) {
@@ -1251,6 +1487,8 @@ main(int argc ATTRIBUTE_UNUSED, char **argv ATTRIBUTE_UNUSED) {
 	}
     }
     ret += runcrazy();
+    ret += runmembudget();
+    ret += runtimelimits();
     if ((nb_errors == 0) && (nb_leaks == 0)) {
         ret = 0;
 	printf("Total %d tests, no errors\n",
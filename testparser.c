@@ -9,16 +9,30 @@
 #include "libxml.h"
 #include <libxml/parser.h>
 #include <libxml/parserInternals.h>
+#include <libxml/pattern.h>
+#include <libxml/relaxng.h>
+#include <libxml/schematron.h>
 #include <libxml/uri.h>
 #include <libxml/xmlreader.h>
+#include <libxml/xmlregexp.h>
+#include <libxml/xmlschemas.h>
+#include <libxml/xmlschemastypes.h>
 #include <libxml/xmlsave.h>
+#include <libxml/xinclude.h>
 #include <libxml/xmlwriter.h>
+#include <libxml/xpath.h>
+#include <libxml/xpathInternals.h>
+#include <libxml/xpointer.h>
 #include <libxml/HTMLparser.h>
 #include <libxml/HTMLtree.h>
+#include <libxml/catalog.h>
+#include <libxml/c14n.h>
+#include <libxml/xmltrace.h>
 
 #include <string.h>
 
-#ifdef LIBXML_SAX1_ENABLED
+#if defined(LIBXML_SAX1_ENABLED) || defined(LIBXML_SCHEMAS_ENABLED) || \
+    defined(LIBXML_RELAXNG_ENABLED) || defined(LIBXML_XPTR_ENABLED)
 static void
 ignoreError(void *ctxt ATTRIBUTE_UNUSED,
             const xmlError *error ATTRIBUTE_UNUSED) {
@@ -136,6 +150,94 @@ testCFileIO(void) {
     return err;
 }
 
+static int cacheOpenCount;
+
+static int
+cacheMatch(const char *uri) {
+    return(strncmp(uri, "cache:", 6) == 0);
+}
+
+static void *
+cacheOpen(const char *uri ATTRIBUTE_UNUSED) {
+    const char **ptr = xmlMalloc(sizeof(*ptr));
+
+    *ptr = "<!ENTITY e 'cached'>";
+    cacheOpenCount++;
+    return(ptr);
+}
+
+static int
+cacheRead(void *context, char *buffer, int len) {
+    const char **ptr = context;
+    int n = strlen(*ptr);
+
+    if (n > len)
+        n = len;
+    memcpy(buffer, *ptr, n);
+    *ptr += n;
+    return(n);
+}
+
+static int
+cacheClose(void *context) {
+    xmlFree(context);
+    return(0);
+}
+
+static int
+testResourceCache(void) {
+    const char *xml =
+        "<!DOCTYPE doc SYSTEM 'cache:doc.dtd'>\n"
+        "<doc>&e;</doc>\n";
+    int options = XML_PARSE_DTDLOAD | XML_PARSE_NOENT;
+    int expect[] = { 1, 1, 1, 2, 3 };
+    int i;
+    int err = 0;
+
+    xmlRegisterInputCallbacks(cacheMatch, cacheOpen, cacheRead, cacheClose);
+    cacheOpenCount = 0;
+    xmlResourceCacheSetLimits(100000, 0);
+
+    for (i = 0; i < 5; i++) {
+        xmlDocPtr doc;
+        xmlChar *content;
+
+        /* Clear after the third parse, disable after the fourth */
+        if (i == 3)
+            xmlResourceCacheClear();
+        else if (i == 4)
+            xmlResourceCacheSetLimits(0, 0);
+
+        doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, options);
+        content = xmlNodeGetContent((xmlNodePtr) doc);
+        if ((content == NULL) || (strcmp((char *) content, "cached") != 0)) {
+            fprintf(stderr, "resource cache: parse %d failed\n", i);
+            err = 1;
+        }
+        if (cacheOpenCount != expect[i]) {
+            fprintf(stderr, "resource cache: parse %d: %d loads\n",
+                    i, cacheOpenCount);
+            err = 1;
+        }
+        xmlFree(content);
+        xmlFreeDoc(doc);
+    }
+
+    /* Too large to be cached */
+    xmlResourceCacheSetLimits(100000, 10);
+    xmlFreeDoc(xmlReadDoc(BAD_CAST xml, NULL, NULL, options));
+    xmlFreeDoc(xmlReadDoc(BAD_CAST xml, NULL, NULL, options));
+    if (cacheOpenCount != 5) {
+        fprintf(stderr, "resource cache: cached large entry\n");
+        err = 1;
+    }
+
+    xmlResourceCacheSetLimits(0, 0);
+    xmlPopInputCallbacks();
+
+    return err;
+}
+
 /*
  * The exact rules when undeclared entities are a fatal error
  * depend on some conditions that aren't recovered from the
@@ -183,1309 +285,11292 @@ testUndeclEntInContent(void) {
     return err;
 }
 
+#ifdef LIBXML_OUTPUT_ENABLED
 static int
-testInvalidCharRecovery(void) {
-    const char *xml = "<doc>&#x10;</doc>";
-    xmlDoc *doc;
+testEntityCopies(void) {
+    const char *content =
+        "s <a x='1'>t<![CDATA[c]]><!--m--><?pi d?></a>"
+        "<d><d><d><d><d><d><d><d><d><d><d><d><d><d><d><d><d><d>x"
+        "</d></d></d></d></d></d></d></d></d></d></d></d></d></d></d></d>"
+        "</d></d><b/> e";
+    const char *nsContent = "<n:x xmlns:n='urn:n'>y</n:x>";
+    xmlBufferPtr buf;
+    xmlChar *dumps[2];
     int err = 0;
+    int i, j;
 
-    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL,
-                     XML_PARSE_RECOVER | XML_PARSE_NOERROR);
-
-    if (strcmp((char *) doc->children->children->content, "\x10") != 0) {
-        fprintf(stderr, "Failed to recover from invalid char ref\n");
-        err = 1;
-    }
-
-    xmlFreeDoc(doc);
-
-    return err;
-}
-
-static void
-testCtxtInputGetterError(void *errCtxt, const xmlError *error) {
-    int *err = errCtxt;
-    xmlParserCtxt *ctxt = error->ctxt;
-    const char *filename;
-    int line, col;
-    unsigned long bytePos;
-    const xmlChar *start;
-    int size, offset;
-
-    xmlCtxtGetInputPosition(ctxt, 0, &filename, &line, &col, &bytePos);
-
-    if (strcmp(filename, "test.xml") != 0 ||
-        line != 4 || col != 11 || bytePos != 62) {
-        fprintf(stderr, "unexpected position: %s %d %d %lu\n",
-                filename, line, col, bytePos);
-        *err = 1;
-    }
+    for (i = 0; i < 2; i++) {
+        xmlDocPtr doc;
+        int size;
 
-    size = 80;
-    xmlCtxtGetInputWindow(ctxt, 0, &start, &size, &offset);
+        buf = xmlBufferCreate();
+        xmlBufferCat(buf, BAD_CAST "<!DOCTYPE doc [<!ENTITY e \"");
+        xmlBufferCat(buf, BAD_CAST content);
+        xmlBufferCat(buf, BAD_CAST "\"><!ENTITY n \"");
+        xmlBufferCat(buf, BAD_CAST nsContent);
+        xmlBufferCat(buf, BAD_CAST "\">]><doc>");
+        for (j = 0; j < 3; j++) {
+            /* Compare with the content inlined */
+            xmlBufferCat(buf, BAD_CAST "<p>a ");
+            xmlBufferCat(buf, BAD_CAST (i ? content : "&e;"));
+            xmlBufferCat(buf, BAD_CAST " b</p>");
+            xmlBufferCat(buf, BAD_CAST (i ? nsContent : "&n;"));
+        }
+        xmlBufferCat(buf, BAD_CAST "</doc>");
 
-    if (strncmp((char *) start, "<doc>&ent;", 10) != 0 ||
-        size != 16 || offset != 10) {
-        fprintf(stderr, "unexpected window: %.10s %d %d\n",
-                start, size, offset);
-        *err = 1;
+        doc = xmlReadDoc(xmlBufferContent(buf), NULL, NULL, XML_PARSE_NOENT);
+        xmlBufferFree(buf);
+        buf = xmlBufferCreate();
+        xmlNodeDump(buf, doc, xmlDocGetRootElement(doc), 0, 0);
+        size = xmlBufferLength(buf);
+        dumps[i] = xmlStrndup(xmlBufferContent(buf), size);
+        xmlBufferFree(buf);
+        xmlFreeDoc(doc);
     }
 
-    xmlCtxtGetInputPosition(ctxt, -1, &filename, &line, &col, &bytePos);
-
-    if (filename != NULL ||
-        line != 1 || col != 11 || bytePos != 10) {
-        fprintf(stderr, "unexpected position: %s %d %d %lu\n",
-                filename, line, col, bytePos);
-        *err = 1;
+    if (!xmlStrEqual(dumps[0], dumps[1])) {
+        fprintf(stderr, "Entity copies differ: %s\n", (char *) dumps[0]);
+        err = 1;
     }
 
-    size = 80;
-    xmlCtxtGetInputWindow(ctxt, -1, &start, &size, &offset);
-
-    if (strncmp((char *) start, "xxx &fail;", 10) != 0 ||
-        size != 14 || offset != 10) {
-        fprintf(stderr, "unexpected window: %.10s %d %d\n",
-                start, size, offset);
-        *err = 1;
-    }
+    xmlFree(dumps[0]);
+    xmlFree(dumps[1]);
+    return err;
 }
 
 static int
-testCtxtInputGetters(void) {
-    const char *xml =
-        "<!DOCTYPE doc [\n"
-        "  <!ENTITY ent 'xxx &fail; xxx'>\n"
-        "]>\n"
-        "<doc>&ent;</doc>\n";
-    xmlParserCtxt *ctxt;
-    xmlDoc *doc;
+testAttrPlans(void) {
+    const char *xml[2] = {
+        "<!DOCTYPE doc ["
+        "<!ATTLIST doc xmlns:p CDATA 'urn:p' t NMTOKENS #IMPLIED>"
+        "<!ATTLIST p:e p:a NMTOKENS 'x' b CDATA 'y'>"
+        "<!ATTLIST e c ID #IMPLIED>"
+        "]>"
+        "<doc t='  a   b '><p:e p:a=' q  r '/><e c=' i '/><p:e/></doc>",
+        "<!DOCTYPE doc ["
+        "<!ATTLIST p:e b NMTOKEN #IMPLIED>"
+        "]>"
+        "<doc t='  a '><p:e xmlns:p='urn:q' b=' z '/></doc>"
+    };
+    const char *expected[2] = {
+        "<doc xmlns:p=\"urn:p\" t=\"a b\"><p:e p:a=\"q r\" b=\"y\"/>"
+        "<e c=\"i\"/><p:e p:a=\"x\" b=\"y\"/></doc>",
+        "<doc t=\"  a \"><p:e xmlns:p=\"urn:q\" b=\"z\"/></doc>"
+    };
+    xmlParserCtxtPtr ctxt;
     int err = 0;
+    int i;
 
+    /* Reuse the context to check that plans don't leak across documents */
     ctxt = xmlNewParserCtxt();
-    xmlCtxtSetErrorHandler(ctxt, testCtxtInputGetterError, &err);
-    doc = xmlCtxtReadDoc(ctxt, BAD_CAST xml, "test.xml", NULL, 0);
-    xmlFreeDoc(doc);
+    for (i = 0; i < 2; i++) {
+        xmlDocPtr doc;
+        xmlBufferPtr buf;
+
+        doc = xmlCtxtReadDoc(ctxt, BAD_CAST xml[i], NULL, NULL,
+                             XML_PARSE_DTDATTR);
+        buf = xmlBufferCreate();
+        xmlNodeDump(buf, doc, xmlDocGetRootElement(doc), 0, 0);
+        if (!xmlStrEqual(xmlBufferContent(buf), BAD_CAST expected[i])) {
+            fprintf(stderr, "Unexpected attributes: %s\n",
+                    (char *) xmlBufferContent(buf));
+            err = 1;
+        }
+        xmlBufferFree(buf);
+        xmlFreeDoc(doc);
+    }
     xmlFreeParserCtxt(ctxt);
 
     return err;
 }
-
-#ifdef LIBXML_VALID_ENABLED
-static void
-testSwitchDtdExtSubset(void *vctxt, const xmlChar *name ATTRIBUTE_UNUSED,
-                       const xmlChar *externalId ATTRIBUTE_UNUSED,
-                       const xmlChar *systemId ATTRIBUTE_UNUSED) {
-    xmlParserCtxtPtr ctxt = vctxt;
-
-    ctxt->myDoc->extSubset = ctxt->_private;
-}
+#endif /* LIBXML_OUTPUT_ENABLED */
 
 static int
-testSwitchDtd(void) {
-    const char dtdContent[] =
-        "<!ENTITY test '<elem1/><elem2/>'>\n";
-    const char docContent[] =
-        "<!DOCTYPE doc SYSTEM 'entities.dtd'>\n"
-        "<doc>&test;</doc>\n";
-    xmlParserInputBufferPtr input;
-    xmlParserCtxtPtr ctxt;
-    xmlDtdPtr dtd;
-    xmlDocPtr doc;
-    xmlEntityPtr ent;
+testInvalidCharRecovery(void) {
+    const char *xml = "<doc>&#x10;</doc>";
+    xmlDoc *doc;
     int err = 0;
 
-    input = xmlParserInputBufferCreateStatic(dtdContent,
-                                             sizeof(dtdContent) - 1,
-                                             XML_CHAR_ENCODING_NONE);
-    dtd = xmlIOParseDTD(NULL, input, XML_CHAR_ENCODING_NONE);
-
-    ctxt = xmlNewParserCtxt();
-    ctxt->_private = dtd;
-    ctxt->sax->externalSubset = testSwitchDtdExtSubset;
-    doc = xmlCtxtReadMemory(ctxt, docContent, sizeof(docContent) - 1, NULL,
-                            NULL, XML_PARSE_NOENT | XML_PARSE_DTDLOAD);
-    xmlFreeParserCtxt(ctxt);
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL,
+                     XML_PARSE_RECOVER | XML_PARSE_NOERROR);
 
-    ent = xmlGetDocEntity(doc, BAD_CAST "test");
-    if (ent->children->doc != NULL) {
-        fprintf(stderr, "Entity content should have NULL doc\n");
+    if (strcmp((char *) doc->children->children->content, "\x10") != 0) {
+        fprintf(stderr, "Failed to recover from invalid char ref\n");
         err = 1;
     }
 
-    /* Free doc before DTD */
-    doc->extSubset = NULL;
     xmlFreeDoc(doc);
-    xmlFreeDtd(dtd);
 
     return err;
 }
-#endif /* LIBXML_VALID_ENABLED */
-
-#ifdef LIBXML_OUTPUT_ENABLED
-static xmlChar *
-dumpNodeList(xmlNodePtr list) {
-    xmlBufferPtr buffer;
-    xmlSaveCtxtPtr save;
-    xmlNodePtr cur;
-    xmlChar *ret;
-
-    buffer = xmlBufferCreate();
-    save = xmlSaveToBuffer(buffer, "UTF-8", 0);
-    for (cur = list; cur != NULL; cur = cur->next)
-        xmlSaveTree(save, cur);
-    xmlSaveClose(save);
-
-    ret = xmlBufferDetach(buffer);
-    xmlBufferFree(buffer);
-    return ret;
-}
 
+/*
+ * Names are hashed while they're scanned. The resulting dictionary
+ * entries must match those of strings added with xmlDictLookup.
+ */
 static int
-testCtxtParseContent(void) {
-    xmlParserCtxtPtr ctxt;
-    xmlParserInputPtr input;
-    xmlDocPtr doc;
-    xmlNodePtr node, list;
-    const char *content;
-    xmlChar *output;
-    int i, j;
+testScannedNames(void) {
+    static const char data[] =
+        "<root attr='1'><x:child xmlns:x='urn:x' x:at='2'/>"
+        "<?target d?></root>";
     int err = 0;
+    int i;
 
-    static const char *const tests[] = {
-        "<!-- c -->\xF0\x9F\x98\x84<a/><b/>end",
-        "text<a:foo><b:foo/></a:foo>text<!-- c -->"
-    };
+    for (i = 0; i < 3; i++) {
+        xmlDictPtr dict, parent = NULL;
+        const xmlChar *root, *attr, *child, *target;
+        xmlParserCtxtPtr ctxt;
+        xmlDocPtr doc;
+        xmlNodePtr cur;
+
+        if (i == 0) {
+            dict = xmlDictCreate();
+        } else if (i == 1) {
+            dict = xmlDictCreateConcurrent();
+        } else {
+            parent = xmlDictCreate();
+            dict = xmlDictCreateSub(parent);
+        }
+        root = xmlDictLookup((parent != NULL) ? parent : dict,
+                             BAD_CAST "root", -1);
+        attr = xmlDictLookup(dict, BAD_CAST "attr", -1);
+        child = xmlDictLookup(dict, BAD_CAST "child", -1);
+        target = xmlDictLookup(dict, BAD_CAST "target", -1);
+
+        ctxt = xmlNewParserCtxt();
+        xmlCtxtSetDict(ctxt, dict);
+        doc = xmlCtxtReadMemory(ctxt, data, sizeof(data) - 1, NULL, NULL,
+                                0);
+        cur = xmlDocGetRootElement(doc);
+        if ((cur == NULL) || (cur->name != root) ||
+            (cur->properties == NULL) ||
+            (cur->properties->name != attr) ||
+            (cur->children == NULL) ||
+            (cur->children->name != child) ||
+            (cur->children->next == NULL) ||
+            (cur->children->next->name != target)) {
+            fprintf(stderr, "testScannedNames: names differ from "
+                    "dictionary entries in dictionary %d\n", i);
+            err = 1;
+        }
 
-    doc = xmlReadDoc(BAD_CAST "<doc xmlns:a='a'><elem xmlns:b='b'/></doc>",
-                     NULL, NULL, 0);
-    node = doc->children->children;
+        xmlFreeDoc(doc);
+        xmlFreeParserCtxt(ctxt);
+        xmlDictFree(dict);
+        xmlDictFree(parent);
+    }
 
-    ctxt = xmlNewParserCtxt();
+    return(err);
+}
 
-    for (i = 0; (size_t) i < sizeof(tests) / sizeof(tests[0]); i++) {
-        content = tests[i];
+/*
+ * Character data is skipped in vector-sized blocks. Put special
+ * characters at every offset relative to the block boundaries.
+ */
+static int
+testCharDataScan(void) {
+    static const char *const specials[] = {
+        "&amp;", "\n", "]", "\t", "\xC3\xA9", "]]", "\r\n",
+        "\xE4\xB8\xAD", "\xF0\x9F\x98\x80"
+    };
+    static const char *const expected[] = {
+        "&", "\n", "]", "\t", "\xC3\xA9", "]]", "\n",
+        "\xE4\xB8\xAD", "\xF0\x9F\x98\x80"
+    };
+    static const char digits[] =
+        "0123456789012345678901234567890123456789"
+        "0123456789012345678901234567890123456789"
+        "01234567890123456789";
+    static const char letters[] =
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghij";
+    char xml[256];
+    char text[256];
+    size_t s;
+    int i;
+    int err = 0;
 
-        for (j = 0; j < 2; j++) {
-            if (j == 0) {
-                input = xmlNewInputFromString(NULL, content,
-                                              XML_INPUT_BUF_STATIC);
-                list = xmlCtxtParseContent(ctxt, input, node, 0);
-            } else {
-                xmlParseInNodeContext(node, content, strlen(content), 0,
-                                      &list);
+    for (s = 0; s < sizeof(specials) / sizeof(specials[0]); s++) {
+        for (i = 0; i < 100; i++) {
+            xmlDocPtr doc;
+            xmlNodePtr root, end;
+            xmlChar *content;
+            int expectedLine;
+
+            snprintf(xml, sizeof(xml), "<doc>%.*s%s%.*s<end/></doc>",
+                     i, digits, specials[s], 100 - i, letters);
+            snprintf(text, sizeof(text), "%.*s%s%.*s",
+                     i, digits, expected[s], 100 - i, letters);
+
+            doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+            if (doc == NULL) {
+                fprintf(stderr, "testCharDataScan: parse failed for %s\n",
+                        xml);
+                err = 1;
+                continue;
             }
 
-            output = dumpNodeList(list);
+            root = xmlDocGetRootElement(doc);
+            content = xmlNodeGetContent(root);
+            if (strcmp((char *) content, text) != 0) {
+                fprintf(stderr, "testCharDataScan: wrong content for %s\n",
+                        xml);
+                err = 1;
+            }
+            xmlFree(content);
 
-            if ((j == 0 && ctxt->nsWellFormed == 0) ||
-                strcmp((char *) output, content) != 0) {
-                fprintf(stderr, "%s failed test %d, got:\n%s\n",
-                        j == 0 ?
-                            "xmlCtxtParseContent" :
-                            "xmlParseInNodeContext",
-                        i, output);
+            expectedLine = (strchr(specials[s], '\n') != NULL) ? 2 : 1;
+            end = xmlGetLastChild(root);
+            if ((end == NULL) || (xmlGetLineNo(end) != expectedLine)) {
+                fprintf(stderr, "testCharDataScan: wrong line for %s\n",
+                        xml);
                 err = 1;
             }
 
-            xmlFree(output);
-            xmlFreeNodeList(list);
+            xmlFreeDoc(doc);
         }
     }
 
-    xmlFreeParserCtxt(ctxt);
-    xmlFreeDoc(doc);
-
     return err;
 }
 
 static int
-testNoBlanks(void) {
-    const xmlChar xml[] =
-        "<refentry>\n"
-        "  <refsect1>\n"
-        "    <para>\n"
-        "      Run <command>tester --help</command> for more options.\n"
-        "    </para>\n"
-        "  </refsect1>\n"
-        "</refentry>\n";
-    const xmlChar expect[] =
-        "<?xml version=\"1.0\"?>\n"
-        "<refentry><refsect1><para>\n"
-        "      Run <command>tester --help</command> for more options.\n"
-        "    </para></refsect1></refentry>\n";
-    xmlDocPtr doc;
-    xmlChar *out;
-    int size;
+testAttValueScan(void) {
+    static const char *const specials[] = {
+        "&amp;", "\n", "\t", "\xC3\xA9", "'", "  ", "&#32; "
+    };
+    static const char *const expected[] = {
+        "&", " ", " ", "\xC3\xA9", "'", "  ", "  "
+    };
+    static const char *const expectedNorm[] = {
+        "&", " ", " ", "\xC3\xA9", "'", " ", " "
+    };
+    static const char digits[] =
+        "0123456789012345678901234567890123456789"
+        "0123456789012345678901234567890123456789"
+        "01234567890123456789";
+    char xml[512];
+    char text[256];
+    char textNorm[256];
+    size_t s;
+    int i;
     int err = 0;
 
-    doc = xmlReadDoc(xml, NULL, NULL, XML_PARSE_NOBLANKS);
-    xmlDocDumpMemory(doc, &out, &size);
-    xmlFreeDoc(doc);
+    for (s = 0; s < sizeof(specials) / sizeof(specials[0]); s++) {
+        for (i = 1; i < 100; i++) {
+            xmlDocPtr doc;
+            xmlNodePtr root;
+            xmlChar *value;
+
+            snprintf(xml, sizeof(xml),
+                     "<!DOCTYPE doc [<!ATTLIST doc n NMTOKENS #IMPLIED>]>"
+                     "<doc a=\"%.*s%s%.*s\" n=\"%.*s%s%.*s\"/>",
+                     i, digits, specials[s], 100 - i, digits,
+                     i, digits, specials[s], 100 - i, digits);
+            snprintf(text, sizeof(text), "%.*s%s%.*s",
+                     i, digits, expected[s], 100 - i, digits);
+            snprintf(textNorm, sizeof(textNorm), "%.*s%s%.*s",
+                     i, digits, expectedNorm[s], 100 - i, digits);
+
+            doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+            if (doc == NULL) {
+                fprintf(stderr, "testAttValueScan: parse failed for %s\n",
+                        xml);
+                err = 1;
+                continue;
+            }
 
-    if (!xmlStrEqual(out, expect)) {
-        fprintf(stderr, "parsing with XML_PARSE_NOBLANKS failed\n");
-        err = 1;
+            root = xmlDocGetRootElement(doc);
+            value = xmlGetProp(root, BAD_CAST "a");
+            if ((value == NULL) || (strcmp((char *) value, text) != 0)) {
+                fprintf(stderr, "testAttValueScan: wrong value for %s\n",
+                        xml);
+                err = 1;
+            }
+            xmlFree(value);
+            value = xmlGetProp(root, BAD_CAST "n");
+            if ((value == NULL) || (strcmp((char *) value, textNorm) != 0)) {
+                fprintf(stderr, "testAttValueScan: wrong normalized value "
+                        "for %s\n", xml);
+                err = 1;
+            }
+            xmlFree(value);
+
+            xmlFreeDoc(doc);
+        }
     }
-    xmlFree(out);
 
     return err;
 }
-
+/*
+ * Valid UTF-8 in character data is skipped in vector-sized blocks.
+ * Invalid sequences must still be reported at the right column.
+ */
 static int
-testSaveNullEncDoc(const char *xml, const char *expect) {
-    xmlDocPtr doc;
-    xmlBufferPtr buffer;
-    xmlSaveCtxtPtr save;
-    const xmlChar *result;
+testUtf8CharDataScan(void) {
+    static const char *const invalid[] = {
+        "\xC3(", "\xED\xA0\x80", "\xEF\xBF\xBE", "\xF4\x90\x80\x80",
+        "\xC0\x80", "\xE0\x80\x80", "\x80"
+    };
+    char xml[1024];
+    char text[1024];
+    size_t s;
+    int i, j;
     int err = 0;
 
-    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    for (i = 0; i < 70; i++) {
+        xmlDocPtr doc;
+        xmlChar *content;
+        int n = 0, m = 0;
 
-    buffer = xmlBufferCreate();
-    save = xmlSaveToBuffer(buffer, NULL, 0);
-    xmlSaveDoc(save, doc);
-    xmlSaveClose(save);
+        n += snprintf(xml, sizeof(xml), "<doc>");
+        for (j = 0; j < 70; j++) {
+            const char *c = (j == i) ? "x" :
+                            (j % 3 == 0) ? "\xE4\xB8\xAD" :
+                            (j % 3 == 1) ? "\xC3\xA9" : "\xF0\x9F\x98\x80";
 
-    result = xmlBufferContent(buffer);
-    if (strcmp((char *) result, expect) != 0) {
-        fprintf(stderr, "xmlSave with NULL encodíng failed\n");
-        err = 1;
+            n += snprintf(xml + n, sizeof(xml) - n, "%s", c);
+            m += snprintf(text + m, sizeof(text) - m, "%s", c);
+        }
+        snprintf(xml + n, sizeof(xml) - n, "</doc>");
+
+        doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+        content = xmlNodeGetContent((xmlNodePtr) doc);
+        if ((content == NULL) || (strcmp((char *) content, text) != 0)) {
+            fprintf(stderr, "testUtf8CharDataScan: wrong content at %d\n", i);
+            err = 1;
+        }
+        xmlFree(content);
+        xmlFreeDoc(doc);
     }
 
-    xmlBufferFree(buffer);
-    xmlFreeDoc(doc);
+    for (s = 0; s < sizeof(invalid) / sizeof(invalid[0]); s++) {
+        for (i = 0; i < 50; i++) {
+            xmlParserCtxtPtr ctxt;
+            const xmlError *error;
+            int n = 0;
+
+            n += snprintf(xml, sizeof(xml), "<doc>");
+            for (j = 0; j < i; j++)
+                n += snprintf(xml + n, sizeof(xml) - n, "\xE4\xB8\xAD");
+            n += snprintf(xml + n, sizeof(xml) - n, "%s", invalid[s]);
+            for (j = 0; j < 50; j++)
+                n += snprintf(xml + n, sizeof(xml) - n, "\xC3\xA9");
+            n += snprintf(xml + n, sizeof(xml) - n, "</doc>");
+
+            ctxt = xmlNewParserCtxt();
+            xmlFreeDoc(xmlCtxtReadMemory(ctxt, xml, n, NULL, NULL,
+                                         XML_PARSE_NOERROR));
+            error = xmlCtxtGetLastError(ctxt);
+            if ((error == NULL) || (error->line != 1) ||
+                (error->int2 != 6 + i)) {
+                fprintf(stderr, "testUtf8CharDataScan: invalid sequence %d "
+                        "at %d not reported at column %d\n",
+                        (int) s, i, 6 + i);
+                err = 1;
+            }
+            xmlFreeParserCtxt(ctxt);
+        }
+    }
 
     return err;
 }
 
+/*
+ * Text without special characters is copied in vector-sized blocks
+ * during serialization. Check special characters at all offsets.
+ */
 static int
-testSaveNullEnc(void) {
+testEscapeScan(void) {
+    static const char *const specials[] = {
+        "<", ">", "&", "\"", "\r", "\n", "\t", "\x01", "\xC3\xA9"
+    };
+    static const char *const text[] = {
+        "&lt;", "&gt;", "&amp;", "&quot;", "&#13;", "\n", "\t",
+        "&#xFFFD;", "\xC3\xA9"
+    };
+    static const char *const ascii[] = {
+        "&lt;", "&gt;", "&amp;", "\"", "&#13;", "\n", "\t",
+        "&#xFFFD;", "&#xE9;"
+    };
+#ifdef LIBXML_OUTPUT_ENABLED
+    static const char *const attr[] = {
+        "&lt;", "&gt;", "&amp;", "&quot;", "&#13;", "&#10;", "&#9;",
+        "&#xFFFD;", "&#xE9;"
+    };
+#endif
+    char fillA[71];
+    char fillB[71];
+    char in[256];
+    char expected[256];
+    size_t s;
+    int i;
     int err = 0;
 
-    err |= testSaveNullEncDoc(
-        "<?xml version=\"1.0\"?><doc>\xC3\x98</doc>",
-        "<?xml version=\"1.0\"?>\n<doc>&#xD8;</doc>\n");
-    err |= testSaveNullEncDoc(
-        "<?xml version=\"1.0\" encoding=\"utf-8\"?><doc>\xC3\x98</doc>",
-        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<doc>\xC3\x98</doc>\n");
-    err |= testSaveNullEncDoc(
-        "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?><doc>\xD8</doc>",
-        "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n<doc>\xD8</doc>\n");
+    memset(fillA, 'a', 70);
+    fillA[70] = 0;
+    memset(fillB, 'b', 70);
+    fillB[70] = 0;
+
+    for (s = 0; s < sizeof(specials) / sizeof(specials[0]); s++) {
+        for (i = 0; i < 70; i++) {
+            xmlChar *res;
+
+            snprintf(in, sizeof(in), "%.*s%s%.*s",
+                     i, fillA, specials[s], 70 - i, fillB);
+
+            snprintf(expected, sizeof(expected), "%.*s%s%.*s",
+                     i, fillA, text[s],
+                     70 - i, fillB);
+            res = xmlEncodeSpecialChars(NULL, BAD_CAST in);
+            if ((res == NULL) || (strcmp((char *) res, expected) != 0)) {
+                fprintf(stderr, "testEscapeScan: xmlEncodeSpecialChars "
+                        "failed for special %d at %d\n", (int) s, i);
+                err = 1;
+            }
+            xmlFree(res);
+
+            snprintf(expected, sizeof(expected), "%.*s%s%.*s",
+                     i, fillA, ascii[s],
+                     70 - i, fillB);
+            res = xmlEncodeEntitiesReentrant(NULL, BAD_CAST in);
+            if ((res == NULL) || (strcmp((char *) res, expected) != 0)) {
+                fprintf(stderr, "testEscapeScan: xmlEncodeEntitiesReentrant "
+                        "failed for special %d at %d\n", (int) s, i);
+                err = 1;
+            }
+            xmlFree(res);
 
-    return err;
-}
+#ifdef LIBXML_OUTPUT_ENABLED
+            {
+                xmlBufferPtr buf = xmlBufferCreate();
+
+                snprintf(expected, sizeof(expected), "%.*s%s%.*s",
+                         i, fillA, attr[s],
+                         70 - i, fillB);
+                xmlAttrSerializeTxtContent(buf, NULL, NULL, BAD_CAST in);
+                if (strcmp((char *) xmlBufferContent(buf), expected) != 0) {
+                    fprintf(stderr, "testEscapeScan: "
+                            "xmlAttrSerializeTxtContent failed for "
+                            "special %d at %d\n", (int) s, i);
+                    err = 1;
+                }
+                xmlBufferFree(buf);
+            }
+#endif
+        }
+    }
 
-static int
-testDocDumpFormatMemoryEnc(void) {
-    const char *xml = "<doc>\xC3\x98</doc>";
-    const char *expect =
-        "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n"
-        "<doc>\xD8</doc>\n";
-    xmlDocPtr doc;
-    xmlChar *text;
-    int len;
-    int err = 0;
+    /* Plain text is returned as is */
+    {
+        const xmlChar *plain = BAD_CAST fillA;
+        xmlChar *res;
 
-    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
-    xmlDocDumpFormatMemoryEnc(doc, &text, &len, "iso-8859-1", 0);
+        if ((xmlEncodeEntitiesNoCopy(NULL, plain) != plain) ||
+            (xmlEncodeSpecialCharsNoCopy(NULL, plain) != plain)) {
+            fprintf(stderr, "testEscapeScan: plain text was copied\n");
+            err = 1;
+        }
 
-    if (strcmp((char *) text, expect) != 0) {
-        fprintf(stderr, "xmlDocDumpFormatMemoryEnc failed\n");
-        err = 1;
+        snprintf(in, sizeof(in), "%s\"%s", fillA, fillB);
+        res = xmlEncodeSpecialCharsNoCopy(NULL, BAD_CAST in);
+        snprintf(expected, sizeof(expected), "%s&quot;%s", fillA, fillB);
+        if ((res == NULL) || (res == BAD_CAST in) ||
+            (strcmp((char *) res, expected) != 0)) {
+            fprintf(stderr, "testEscapeScan: xmlEncodeSpecialCharsNoCopy "
+                    "failed\n");
+            err = 1;
+        }
+        if (res != BAD_CAST in)
+            xmlFree(res);
     }
 
-    xmlFree(text);
-    xmlFreeDoc(doc);
     return err;
 }
-#endif /* LIBXML_OUTPUT_ENABLED */
 
-#ifdef LIBXML_SAX1_ENABLED
+
+/*
+ * The UTF-16 converters handle runs of ASCII in vector-sized blocks.
+ * Put other characters at every offset relative to the block
+ * boundaries and check both directions.
+ */
 static int
-testBalancedChunk(void) {
-    xmlNodePtr list;
-    xmlNodePtr elem;
-    int ret;
+testUTF16Conversion(void) {
+    static const char *const specials[] = {
+        "\x7F", "\xC2\x80", "\xC3\xA9", "\xE4\xB8\xAD", "\xF0\x9F\x98\x80"
+    };
+    /* UTF-16 code units of the specials */
+    static const unsigned short units[][2] = {
+        { 0x007F, 0 }, { 0x0080, 0 }, { 0x00E9, 0 }, { 0x4E2D, 0 },
+        { 0xD83D, 0xDE00 }
+    };
+    static const char letters[] =
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghij";
+    static const char *const encodings[] = { "UTF-16LE", "UTF-16BE" };
+    char utf8[256];
+    unsigned char expect[512];
+    size_t e, s;
+    int i;
     int err = 0;
 
-    ret = xmlParseBalancedChunkMemory(NULL, NULL, NULL, 0,
-            BAD_CAST "start <node xml:lang='en'>abc</node> end", &list);
+    for (e = 0; e < 2; e++) {
+        xmlCharEncodingHandlerPtr handler;
+        int big = (e == 1);
+
+        handler = xmlFindCharEncodingHandler(encodings[e]);
+
+        for (s = 0; s < sizeof(specials) / sizeof(specials[0]); s++) {
+            for (i = 0; i < 100; i++) {
+                xmlBufferPtr in, utf16, back;
+                size_t len = 0;
+                int j, k;
+
+                snprintf(utf8, sizeof(utf8), "%.*s%s%.*s",
+                         i, letters, specials[s], 100 - i, letters);
+
+                for (j = 0; j < 100 + 2; j++) {
+                    unsigned c;
+
+                    if (j < i)
+                        c = letters[j];
+                    else if (j == i)
+                        c = units[s][0];
+                    else if ((j == i + 1) && (units[s][1] != 0))
+                        c = units[s][1];
+                    else if (j - (units[s][1] != 0) <= 100)
+                        c = letters[j - 1 - (units[s][1] != 0) - i];
+                    else
+                        break;
+                    expect[len++] = big ? c >> 8 : c & 0xFF;
+                    expect[len++] = big ? c & 0xFF : c >> 8;
+                }
 
-    if ((ret != XML_ERR_OK) ||
-        (list == NULL) ||
-        ((elem = list->next) == NULL) ||
-        (elem->type != XML_ELEMENT_NODE) ||
-        (elem->nsDef == NULL) ||
-        (!xmlStrEqual(elem->nsDef->href, XML_XML_NAMESPACE))) {
-        fprintf(stderr, "xmlParseBalancedChunkMemory failed\n");
-        err = 1;
-    }
+                in = xmlBufferCreate();
+                utf16 = xmlBufferCreate();
+                back = xmlBufferCreate();
+                xmlBufferCCat(in, utf8);
+
+                xmlCharEncOutFunc(handler, utf16, in);
+                if ((xmlBufferLength(utf16) != (int) len) ||
+                    (memcmp(xmlBufferContent(utf16), expect, len) != 0)) {
+                    fprintf(stderr, "testUTF16Conversion: %s output "
+                            "differs for special %d at %d\n",
+                            encodings[e], (int) s, i);
+                    err = 1;
+                }
 
-    xmlFreeNodeList(list);
+                k = xmlCharEncInFunc(handler, back, utf16);
+                if ((k < 0) ||
+                    (strcmp((char *) xmlBufferContent(back), utf8) != 0)) {
+                    fprintf(stderr, "testUTF16Conversion: %s input "
+                            "differs for special %d at %d\n",
+                            encodings[e], (int) s, i);
+                    err = 1;
+                }
 
-    return(err);
-}
-#endif
+                xmlBufferFree(back);
+                xmlBufferFree(utf16);
+                xmlBufferFree(in);
+            }
+        }
 
-#ifdef LIBXML_PUSH_ENABLED
-static int
-testHugePush(void) {
-    xmlParserCtxtPtr ctxt;
-    int err, i;
+        /* Unpaired surrogate after a long ASCII run */
+        {
+            xmlBufferPtr in = xmlBufferCreate();
+            xmlBufferPtr out = xmlBufferCreate();
+            unsigned char bad[2] = { 0xD8, 0x00 };
 
-    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+            for (i = 0; i < 40; i++) {
+                unsigned char a[2] = { 0, 'a' };
 
-    /*
-     * Push parse a document larger than XML_MAX_LOOKUP_LIMIT
-     * (10,000,000 bytes). This mainly tests whether shrinking the
-     * buffer works when push parsing.
-     */
-    xmlParseChunk(ctxt, "<doc>", 5, 0);
-    for (i = 0; i < 1000000; i++)
-        xmlParseChunk(ctxt, "<elem>text</elem>", 17, 0);
-    xmlParseChunk(ctxt, "</doc>", 6, 1);
+                if (!big) {
+                    a[0] = 'a';
+                    a[1] = 0;
+                }
+                xmlBufferAdd(in, a, 2);
+            }
+            if (!big) {
+                bad[0] = 0x00;
+                bad[1] = 0xD8;
+            }
+            xmlBufferAdd(in, bad, 2);
+            xmlBufferAdd(in, BAD_CAST (big ? "\0a" : "a\0"), 2);
+
+            /* Converts the ASCII run, then fails */
+            xmlCharEncInFunc(handler, out, in);
+            if ((xmlBufferLength(out) != 40) ||
+                (xmlCharEncInFunc(handler, out, in) >= 0)) {
+                fprintf(stderr, "testUTF16Conversion: %s accepted "
+                        "unpaired surrogate\n", encodings[e]);
+                err = 1;
+            }
 
-    err = ctxt->wellFormed ? 0 : 1;
-    xmlFreeDoc(ctxt->myDoc);
-    xmlFreeParserCtxt(ctxt);
+            xmlBufferFree(out);
+            xmlBufferFree(in);
+        }
+
+        xmlCharEncCloseFunc(handler);
+    }
 
     return err;
 }
 
+/*
+ * Single-byte encodings copy ASCII runs a vector at a time and map
+ * other bytes through tables. Put a non-ASCII character at every
+ * offset relative to the block boundaries and check both directions.
+ */
 static int
-testHugeEncodedChunk(void) {
-    xmlBufferPtr buf;
-    xmlChar *chunk;
-    xmlParserCtxtPtr ctxt;
-    int err = 0, i;
+testSingleByteConversion(void) {
+    static const struct {
+        const char *encoding;
+        const char *utf8;
+        unsigned char byte;
+    } specials[] = {
+        { "ISO-8859-1", "\xC2\x80", 0x80 },
+        { "ISO-8859-1", "\xC3\xBF", 0xFF },
+        { "windows-1252", "\xE2\x82\xAC", 0x80 },
+        { "windows-1252", "\xC5\xA0", 0x8A },
+        { "windows-1252", "\xC3\xA9", 0xE9 },
+        { "ASCII", "\x7F", 0x7F }
+    };
+    static const char letters[] =
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghij";
+    char utf8[256];
+    unsigned char expect[256];
+    size_t s;
+    int i;
+    int err = 0;
 
-    /*
-     * Test the push parser with a built-in encoding handler like ISO-8859-1
-     * and a chunk larger than the initial decoded buffer (currently 4 KB).
-     */
-    buf = xmlBufferCreate();
-    xmlBufferCat(buf,
-            BAD_CAST "<?xml version='1.0' encoding='ISO-8859-1'?>\n");
-    xmlBufferCat(buf, BAD_CAST "<doc><!-- ");
-    for (i = 0; i < 2000; i++)
-        xmlBufferCat(buf, BAD_CAST "0123456789");
-    xmlBufferCat(buf, BAD_CAST " --></doc>");
-    chunk = xmlBufferDetach(buf);
-    xmlBufferFree(buf);
+    for (s = 0; s < sizeof(specials) / sizeof(specials[0]); s++) {
+        xmlCharEncodingHandlerPtr handler;
 
-    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        handler = xmlFindCharEncodingHandler(specials[s].encoding);
 
-    xmlParseChunk(ctxt, (char *) chunk, xmlStrlen(chunk), 0);
-    xmlParseChunk(ctxt, NULL, 0, 1);
+        for (i = 0; i < 100; i++) {
+            xmlBufferPtr in, out, back;
+            int k;
 
-    if (!ctxt->wellFormed)
-        err = 1;
-    xmlFreeDoc(ctxt->myDoc);
-    xmlFreeParserCtxt(ctxt);
-    xmlFree(chunk);
+            snprintf(utf8, sizeof(utf8), "%.*s%s%.*s",
+                     i, letters, specials[s].utf8, 100 - i, letters);
+            memcpy(expect, letters, i);
+            expect[i] = specials[s].byte;
+            memcpy(expect + i + 1, letters, 100 - i);
 
-    /*
-     * Test the push parser with
-     *
-     * - a single call to xmlParseChunk,
-     * - a non-UTF8 encoding,
-     * - a chunk larger then MINLEN (4000 bytes).
-     *
-     * This verifies that the whole buffer is processed in the initial
-     * charset conversion.
-     */
-    buf = xmlBufferCreate();
-    xmlBufferCat(buf,
-            BAD_CAST "<?xml version='1.0' encoding='ISO-8859-1'?>\n");
-    xmlBufferCat(buf, BAD_CAST "<doc>");
-    /* 20,000 characters */
-    for (i = 0; i < 2000; i++)
-        xmlBufferCat(buf, BAD_CAST "0123456789");
-    xmlBufferCat(buf, BAD_CAST "</doc>");
-    chunk = xmlBufferDetach(buf);
-    xmlBufferFree(buf);
+            in = xmlBufferCreate();
+            out = xmlBufferCreate();
+            back = xmlBufferCreate();
+            xmlBufferCCat(in, utf8);
 
-    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+            xmlCharEncOutFunc(handler, out, in);
+            if ((xmlBufferLength(out) != 101) ||
+                (memcmp(xmlBufferContent(out), expect, 101) != 0)) {
+                fprintf(stderr, "testSingleByteConversion: %s output "
+                        "differs for special %d at %d\n",
+                        specials[s].encoding, (int) s, i);
+                err = 1;
+            }
 
-    xmlParseChunk(ctxt, (char *) chunk, xmlStrlen(chunk), 1);
+            k = xmlCharEncInFunc(handler, back, out);
+            if ((k < 0) ||
+                (strcmp((char *) xmlBufferContent(back), utf8) != 0)) {
+                fprintf(stderr, "testSingleByteConversion: %s input "
+                        "differs for special %d at %d\n",
+                        specials[s].encoding, (int) s, i);
+                err = 1;
+            }
 
-    if (!ctxt->wellFormed)
-        err = 1;
-    xmlFreeDoc(ctxt->myDoc);
-    xmlFreeParserCtxt(ctxt);
-    xmlFree(chunk);
+            xmlBufferFree(back);
+            xmlBufferFree(out);
+            xmlBufferFree(in);
+        }
+
+        xmlCharEncCloseFunc(handler);
+    }
+
+    /* Non-ASCII byte after a long ASCII run */
+    {
+        xmlCharEncodingHandlerPtr handler;
+        xmlBufferPtr in = xmlBufferCreate();
+        xmlBufferPtr out = xmlBufferCreate();
+
+        handler = xmlFindCharEncodingHandler("ASCII");
+        xmlBufferAdd(in, BAD_CAST letters, 40);
+        xmlBufferAdd(in, BAD_CAST "\x80" "a", 2);
+
+        /* Converts the ASCII run, then fails */
+        xmlCharEncInFunc(handler, out, in);
+        if ((xmlBufferLength(out) != 40) ||
+            (xmlCharEncInFunc(handler, out, in) >= 0)) {
+            fprintf(stderr, "testSingleByteConversion: ASCII accepted "
+                    "non-ASCII byte\n");
+            err = 1;
+        }
+
+        xmlCharEncCloseFunc(handler);
+        xmlBufferFree(out);
+        xmlBufferFree(in);
+    }
 
     return err;
 }
 
+/*
+ * The UTF-8 string functions skip well-formed prefixes a vector at a
+ * time. Check them against known positions for every truncation of a
+ * long mixed string and with broken continuations.
+ */
 static int
-testPushCDataEnd(void) {
+testUTF8Strings(void) {
+    /* 4 characters in 10 bytes */
+    static const char unit[] = "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80";
+    static const int offsets[] = { 0, 1, 3, 6, 10 };
+    char str[1001];
+    char save;
+    const xmlChar *pos;
+    xmlChar *sub;
+    int i, n, len;
     int err = 0;
-    int k;
 
-    for (k = 0; k < 4; k++) {
-        xmlBufferPtr buf;
-        xmlChar *chunk;
-        xmlParserCtxtPtr ctxt;
-        int i;
+    for (i = 0; i < 100; i++)
+        memcpy(str + 10 * i, unit, 10);
+    str[1000] = 0;
 
-        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
-        xmlCtxtSetOptions(ctxt, XML_PARSE_NOERROR);
-
-        /*
-         * Push parse text data with ']]>' split across chunks.
-         */
-        buf = xmlBufferCreate();
-        xmlBufferCCat(buf, "<doc>");
-
-        /*
-         * Also test xmlParseCharDataCopmlex
-         */
-        if (k & 1)
-            xmlBufferCCat(buf, "x");
-        else
-            xmlBufferCCat(buf, "\xC3\xA4");
+    for (n = 0; n <= 1000; n++) {
+        int expect = -1;
 
-        /*
-         * Create enough data to trigger a "characters" SAX callback.
-         * (XML_PARSER_BIG_BUFFER_SIZE = 300)
-         */
-        for (i = 0; i < 2000; i++)
-            xmlBufferCCat(buf, "x");
+        for (i = 0; i < 5; i++) {
+            if (n % 10 == offsets[i])
+                expect = n / 10 * 4 + i;
+        }
+        save = str[n];
+        str[n] = 0;
+        len = xmlUTF8Strlen(BAD_CAST str);
+        str[n] = save;
+        if (len != expect) {
+            fprintf(stderr, "testUTF8Strings: xmlUTF8Strlen returned %d "
+                    "for %d bytes\n", len, n);
+            err = 1;
+        }
+    }
 
-        if (k & 2)
-            xmlBufferCCat(buf, "]");
-        else
-            xmlBufferCCat(buf, "]]");
+    for (n = 0; n <= 450; n++) {
+        int expect = n >= 400 ? 1000 : n / 4 * 10 + offsets[n % 4];
 
-        chunk = xmlBufferDetach(buf);
-        xmlBufferFree(buf);
+        len = xmlUTF8Strsize(BAD_CAST str, n);
+        pos = xmlUTF8Strpos(BAD_CAST str, n);
+        if ((len != expect) ||
+            ((n <= 400) ? (pos != BAD_CAST str + expect) : (pos != NULL))) {
+            fprintf(stderr, "testUTF8Strings: xmlUTF8Strsize or "
+                    "xmlUTF8Strpos failed for %d\n", n);
+            err = 1;
+        }
 
-        xmlParseChunk(ctxt, (char *) chunk, xmlStrlen(chunk), 0);
-        if (k & 2)
-            xmlParseChunk(ctxt, "]>xxx</doc>", 11, 1);
-        else
-            xmlParseChunk(ctxt, ">xxx</doc>", 10, 1);
+        sub = xmlUTF8Strsub(BAD_CAST str, n, 5);
+        if ((n <= 400) ?
+            ((sub == NULL) ||
+             (strncmp((char *) sub, str + expect,
+                      xmlUTF8Strsize(BAD_CAST str + expect, 5)) != 0)) :
+            (sub != NULL)) {
+            fprintf(stderr, "testUTF8Strings: xmlUTF8Strsub failed for %d\n",
+                    n);
+            err = 1;
+        }
+        xmlFree(sub);
+    }
 
-        if (ctxt->errNo != XML_ERR_MISPLACED_CDATA_END) {
-            fprintf(stderr, "xmlParseChunk failed to detect CData end: %d\n",
-                    ctxt->errNo);
+    /* Missing continuation bytes */
+    for (n = 0; n < 1000; n++) {
+        if ((str[n] & 0xC0) != 0x80)
+            continue;
+        save = str[n];
+        str[n] = 'x';
+        len = xmlUTF8Strlen(BAD_CAST str);
+        str[n] = save;
+        if (len != -1) {
+            fprintf(stderr, "testUTF8Strings: xmlUTF8Strlen accepted "
+                    "broken sequence at %d\n", n);
             err = 1;
         }
+    }
 
-        xmlFree(chunk);
-        xmlFreeDoc(ctxt->myDoc);
-        xmlFreeParserCtxt(ctxt);
+    if ((xmlStrstr(BAD_CAST str, BAD_CAST "\x80""a\xC3") !=
+         BAD_CAST str + 9) ||
+        (xmlStrstr(BAD_CAST str, BAD_CAST "aa") != NULL) ||
+        (xmlStrstr(BAD_CAST str, BAD_CAST "") != BAD_CAST str) ||
+        (xmlStrncmp(BAD_CAST str, BAD_CAST "a\xC3\xA9x", 3) != 0) ||
+        (xmlStrncmp(BAD_CAST str, BAD_CAST "a\xC3\xA9x", 4) <= 0) ||
+        (!xmlStrEqual(BAD_CAST str + 990, BAD_CAST unit))) {
+        fprintf(stderr, "testUTF8Strings: byte string functions failed\n");
+        err = 1;
     }
 
     return err;
 }
-#endif /* PUSH */
 
-#ifdef LIBXML_HTML_ENABLED
-static int
-testHtmlIds(void) {
-    const char *htmlContent =
-        "<html><body><div id='myId'>Hello, World!</div></body></html>";
-    htmlDocPtr doc;
-    xmlAttrPtr node;
+static void
+testCtxtInputGetterError(void *errCtxt, const xmlError *error) {
+    int *err = errCtxt;
+    xmlParserCtxt *ctxt = error->ctxt;
+    const char *filename;
+    int line, col;
+    unsigned long bytePos;
+    const xmlChar *start;
+    int size, offset;
 
-    doc = htmlReadDoc(BAD_CAST htmlContent, NULL, NULL, 0);
-    if (doc == NULL) {
-        fprintf(stderr, "could not parse HTML content\n");
-        return 1;
+    xmlCtxtGetInputPosition(ctxt, 0, &filename, &line, &col, &bytePos);
+
+    if (strcmp(filename, "test.xml") != 0 ||
+        line != 4 || col != 11 || bytePos != 62) {
+        fprintf(stderr, "unexpected position: %s %d %d %lu\n",
+                filename, line, col, bytePos);
+        *err = 1;
     }
 
-    node = xmlGetID(doc, BAD_CAST "myId");
-    if (node == NULL) {
-        fprintf(stderr, "xmlGetID doesn't work on HTML\n");
-        return 1;
+    size = 80;
+    xmlCtxtGetInputWindow(ctxt, 0, &start, &size, &offset);
+
+    if (strncmp((char *) start, "<doc>&ent;", 10) != 0 ||
+        size != 16 || offset != 10) {
+        fprintf(stderr, "unexpected window: %.10s %d %d\n",
+                start, size, offset);
+        *err = 1;
     }
 
-    xmlFreeDoc(doc);
-    return 0;
-}
+    xmlCtxtGetInputPosition(ctxt, -1, &filename, &line, &col, &bytePos);
 
-#define MHE "meta http-equiv=\"Content-Type\""
+    if (filename != NULL ||
+        line != 1 || col != 11 || bytePos != 10) {
+        fprintf(stderr, "unexpected position: %s %d %d %lu\n",
+                filename, line, col, bytePos);
+        *err = 1;
+    }
+
+    size = 80;
+    xmlCtxtGetInputWindow(ctxt, -1, &start, &size, &offset);
+
+    if (strncmp((char *) start, "xxx &fail;", 10) != 0 ||
+        size != 14 || offset != 10) {
+        fprintf(stderr, "unexpected window: %.10s %d %d\n",
+                start, size, offset);
+        *err = 1;
+    }
+}
 
-#ifdef LIBXML_OUTPUT_ENABLED
 static int
-testHtmlInsertMetaEncoding(void) {
-    /* We currently require a head element to be present. */
-    const char *html =
-        "<html>"
-        "<head></head>"
-        "<body>text</body>"
-        "</html>\n";
-    const char *expect =
-        "<html>"
-        "<head><meta charset=\"utf-8\"></head>"
-        "<body>text</body>"
-        "</html>\n";
-    htmlDocPtr doc;
-    xmlBufferPtr buf;
-    xmlSaveCtxtPtr save;
-    xmlChar *out;
-    int size, err = 0;
+testPoolAlloc(void) {
+    void *ptrs[1000];
+    int before;
+    int i, j;
+    int err = 0;
 
+    before = xmlMemUsed();
 
-    doc = htmlReadDoc(BAD_CAST html, NULL, NULL, HTML_PARSE_NODEFDTD);
+    for (i = 0; i < 1000; i++) {
+        size_t size = (i * 37) % 1200;
 
-    /* xmlSave updates meta tags */
-    buf = xmlBufferCreate();
-    save = xmlSaveToBuffer(buf, "utf-8", 0);
-    xmlSaveDoc(save, doc);
-    xmlSaveClose(save);
-    if (!xmlStrEqual(xmlBufferContent(buf), BAD_CAST expect)) {
-        fprintf(stderr, "meta tag insertion failed when serializing\n");
+        ptrs[i] = xmlPoolMalloc(size);
+        if (ptrs[i] == NULL) {
+            fprintf(stderr, "xmlPoolMalloc failed\n");
+            return(1);
+        }
+        memset(ptrs[i], i & 0xFF, size);
+    }
+
+    /* Grow within and across size classes */
+    for (i = 0; i < 1000; i += 3) {
+        size_t size = (i * 37) % 1200;
+        unsigned char *tmp = xmlPoolRealloc(ptrs[i], size + 200);
+
+        if (tmp == NULL) {
+            fprintf(stderr, "xmlPoolRealloc failed\n");
+            return(1);
+        }
+        for (j = 0; j < (int) size; j++) {
+            if (tmp[j] != (i & 0xFF)) {
+                fprintf(stderr, "xmlPoolRealloc lost data\n");
+                err = 1;
+                break;
+            }
+        }
+        ptrs[i] = tmp;
+    }
+
+    if (xmlMemUsed() - before < 500000) {
+        fprintf(stderr, "xmlPoolMalloc isn't accounted: %d\n",
+                xmlMemUsed() - before);
         err = 1;
     }
-    xmlBufferFree(buf);
 
-    htmlSetMetaEncoding(doc, BAD_CAST "utf-8");
-    /* htmlDocDumpMemoryFormat doesn't update meta tags */
-    htmlDocDumpMemoryFormat(doc, &out, &size, 0);
-    if (!xmlStrEqual(out, BAD_CAST expect)) {
-        fprintf(stderr, "htmlSetMetaEncoding insertion failed\n");
+    for (i = 0; i < 1000; i++)
+        xmlPoolFree(ptrs[i]);
+
+    /* Freed blocks are reused */
+    ptrs[0] = xmlPoolMalloc(40);
+    ptrs[1] = xmlPoolStrdup("pooled");
+    if ((ptrs[0] == NULL) || (ptrs[1] == NULL) ||
+        (strcmp(ptrs[1], "pooled") != 0)) {
+        fprintf(stderr, "xmlPoolStrdup failed\n");
         err = 1;
     }
-    xmlFree(out);
+    xmlPoolFree(ptrs[0]);
+    xmlPoolFree(ptrs[1]);
 
-    xmlFreeDoc(doc);
     return err;
 }
 
-static int
-testHtmlUpdateMetaEncoding(void) {
-    /* We rely on the implementation adjusting all meta tags */
-    const char *html =
-        "<html>\n"
-        "    <head>\n"
-        "        <meta charset=\"utf-8\">\n"
-        "        <meta charset=\"  foo  \">\n"
-        "        <meta charset=\"\">\n"
-        "        <" MHE " content=\"text/html; ChArSeT=foo\">\n"
-        "        <" MHE " content=\"text/html; charset = \">\n"
-        "        <" MHE " content=\"text/html; charset = '  foo  '\">\n"
-        "        <" MHE " content=\"text/html; charset = '  foo  \">\n"
-        "        <" MHE " content='text/html; charset = \"  foo  \"'>\n"
-        "        <" MHE " content='text/html; charset = \"  foo  '>\n"
-        "        <" MHE " content=\"charset ; charset = bar; baz\">\n"
-        "        <" MHE " content=\"text/html\">\n"
-        "        <" MHE " content=\"\">\n"
-        "        <" MHE ">\n"
-        "    </head>\n"
-        "    <body></body>\n"
-        "</html>\n";
-    const char *expect =
-        "<html>\n"
-        "    <head>\n"
-        "        <meta charset=\"utf-8\">\n"
-        "        <meta charset=\"  utf-8  \">\n"
-        "        <meta charset=\"utf-8\">\n"
-        "        <" MHE " content=\"text/html; ChArSeT=utf-8\">\n"
-        "        <" MHE " content=\"text/html; charset = \">\n"
-        "        <" MHE " content=\"text/html; charset = '  utf-8  '\">\n"
-        "        <" MHE " content=\"text/html; charset = '  foo  \">\n"
-        "        <" MHE " content=\"text/html; charset = &quot;  utf-8  &quot;\">\n"
-        "        <" MHE " content=\"text/html; charset = &quot;  foo  \">\n"
-        "        <" MHE " content=\"charset ; charset = utf-8; baz\">\n"
-        "        <" MHE " content=\"text/html\">\n"
-        "        <" MHE " content=\"\">\n"
-        "        <" MHE ">\n"
-        "    </head>\n"
-        "    <body></body>\n"
-        "</html>\n";
-    htmlDocPtr doc;
-    xmlBufferPtr buf;
-    xmlSaveCtxtPtr save;
-    xmlChar *out;
-    int size, err = 0;
+/*
+ * Sites without a file name are keyed by return address, so all
+ * allocations must come from one call instruction regardless of
+ * inlining or loop unrolling. Storing the result keeps the call out
+ * of tail position.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#elif defined(_MSC_VER)
+__declspec(noinline)
+#endif
+static void
+testAllocProfileSite(void **ptr, size_t size) {
+    *ptr = xmlMemMalloc(size);
+}
 
-    doc = htmlReadDoc(BAD_CAST html, NULL, NULL, HTML_PARSE_NODEFDTD);
+static int
+testAllocProfile(void) {
+    void *ptrs[3];
+    FILE *tmp;
+    char line[200];
+    int found = 0;
+    int i;
 
-    /* xmlSave updates meta tags */
-    buf = xmlBufferCreate();
-    save = xmlSaveToBuffer(buf, NULL, 0);
-    xmlSaveDoc(save, doc);
-    xmlSaveClose(save);
-    if (!xmlStrEqual(xmlBufferContent(buf), BAD_CAST expect)) {
-        fprintf(stderr, "meta tag update failed when serializing\n");
-        err = 1;
+    if (xmlMemProfileStart() < 0) {
+        fprintf(stderr, "xmlMemProfileStart failed\n");
+        return(1);
     }
-    xmlBufferFree(buf);
 
-    xmlFree((xmlChar *) doc->encoding);
-    doc->encoding = NULL;
-    htmlSetMetaEncoding(doc, BAD_CAST "utf-8");
-    /* htmlDocDumpMemoryFormat doesn't update meta tags */
-    htmlDocDumpMemoryFormat(doc, &out, &size, 0);
-    if (!xmlStrEqual(out, BAD_CAST expect)) {
-        fprintf(stderr, "htmlSetMetaEncoding update failed\n");
-        err = 1;
-    }
-    xmlFree(out);
+    for (i = 0; i < 3; i++)
+        testAllocProfileSite(&ptrs[i], 1234);
+    xmlMemFree(ptrs[0]);
 
-    xmlFreeDoc(doc);
-    return err;
-}
-#endif /* LIBXML_OUTPUT_ENABLED */
+    xmlMemProfileStop();
 
-#ifdef LIBXML_PUSH_ENABLED
-static int
-testHtmlPushWithEncoding(void) {
-    htmlParserCtxtPtr ctxt;
-    htmlDocPtr doc;
-    htmlNodePtr node;
-    int err = 0;
+    tmp = tmpfile();
+    if (tmp == NULL) {
+        xmlMemFree(ptrs[1]);
+        xmlMemFree(ptrs[2]);
+        return(0);
+    }
+    xmlMemProfileDump(tmp);
+    rewind(tmp);
 
-    ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL,
-                                    XML_CHAR_ENCODING_UTF8);
-    htmlParseChunk(ctxt, "-\xC3\xA4-", 4, 1);
+    while (fgets(line, sizeof(line), tmp) != NULL) {
+        unsigned long count, bytes, live, peak;
 
-    doc = ctxt->myDoc;
-    if (!xmlStrEqual(doc->encoding, BAD_CAST "UTF-8")) {
-        fprintf(stderr, "testHtmlPushWithEncoding failed\n");
-        err = 1;
+        if ((sscanf(line, "%lu %lu %lu %lu",
+                    &count, &bytes, &live, &peak) == 4) &&
+            (count == 3) && (bytes == 3 * 1234) &&
+            (live == 2 * 1234) && (peak == 3 * 1234))
+            found = 1;
     }
+    fclose(tmp);
 
-    node = xmlDocGetRootElement(doc)->children->children;
-    if (!xmlStrEqual(node->content, BAD_CAST "-\xC3\xA4-")) {
-        fprintf(stderr, "testHtmlPushWithEncoding failed\n");
-        err = 1;
+    xmlMemFree(ptrs[1]);
+    xmlMemFree(ptrs[2]);
+
+    if (!found) {
+        fprintf(stderr, "allocation profile misses call site\n");
+        return(1);
     }
 
-    xmlFreeDoc(doc);
-    htmlFreeParserCtxt(ctxt);
-    return err;
+    return(0);
 }
-#endif
-#endif
 
-#ifdef LIBXML_READER_ENABLED
 static int
-testReaderEncoding(void) {
-    xmlBuffer *buf;
-    xmlTextReader *reader;
-    xmlChar *xml;
-    const xmlChar *encoding;
+testCtxtInputGetters(void) {
+    const char *xml =
+        "<!DOCTYPE doc [\n"
+        "  <!ENTITY ent 'xxx &fail; xxx'>\n"
+        "]>\n"
+        "<doc>&ent;</doc>\n";
+    xmlParserCtxt *ctxt;
+    xmlDoc *doc;
     int err = 0;
-    int i;
 
-    buf = xmlBufferCreate();
-    xmlBufferCCat(buf, "<?xml version='1.0' encoding='ISO-8859-1'?>\n");
-    xmlBufferCCat(buf, "<doc>");
-    for (i = 0; i < 8192; i++)
-        xmlBufferCCat(buf, "x");
-    xmlBufferCCat(buf, "</doc>");
-    xml = xmlBufferDetach(buf);
-    xmlBufferFree(buf);
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetErrorHandler(ctxt, testCtxtInputGetterError, &err);
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST xml, "test.xml", NULL, 0);
+    xmlFreeDoc(doc);
+    xmlFreeParserCtxt(ctxt);
 
-    reader = xmlReaderForDoc(BAD_CAST xml, NULL, NULL, 0);
-    xmlTextReaderRead(reader);
-    encoding = xmlTextReaderConstEncoding(reader);
+    return err;
+}
 
-    if (!xmlStrEqual(encoding, BAD_CAST "ISO-8859-1")) {
-        fprintf(stderr, "testReaderEncoding failed\n");
-        err = 1;
-    }
+typedef struct {
+    char *messages[20];
+    int nbErrors;
+    int nbFormatted;
+} testDeferredData;
 
-    xmlFreeTextReader(reader);
-    xmlFree(xml);
-    return err;
+static void
+testDeferredError(void *vctxt, const xmlError *error) {
+    testDeferredData *data = vctxt;
+
+    if (error->message != NULL) {
+        data->nbFormatted += 1;
+        if (data->nbErrors < 20)
+            data->messages[data->nbErrors] =
+                (char *) xmlStrdup(BAD_CAST error->message);
+    }
+    data->nbErrors += 1;
 }
 
-#ifdef LIBXML_OUTPUT_ENABLED
 static int
-testReaderContent(void) {
-    xmlTextReader *reader;
-    const xmlChar *xml = BAD_CAST "<d>x<e>y</e><f>z</f></d>";
-    xmlChar *string;
+testDeferredErrors(void) {
+    const char *xml =
+        "<doc a='1' a='2'>\n"
+        "  <x></y>\n"
+        "  &undefined;\n"
+        "  <z attr=v/>\n"
+        "</doc>\n";
+    testDeferredData normal, deferred;
+    const xmlError *last;
+    xmlParserCtxt *ctxt;
+    xmlError rec;
+    xmlDoc *doc;
+    int i, n;
     int err = 0;
 
-    reader = xmlReaderForDoc(xml, NULL, NULL, 0);
-    xmlTextReaderRead(reader);
+    memset(&normal, 0, sizeof(normal));
+    memset(&deferred, 0, sizeof(deferred));
 
-    string = xmlTextReaderReadOuterXml(reader);
-    if (!xmlStrEqual(string, xml)) {
-        fprintf(stderr, "xmlTextReaderReadOuterXml failed\n");
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetErrorHandler(ctxt, testDeferredError, &normal);
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST xml, "test.xml", NULL,
+                         XML_PARSE_RECOVER);
+    xmlFreeDoc(doc);
+
+    if (xmlCtxtSetDeferredErrors(ctxt, 3) < 0) {
+        fprintf(stderr, "testDeferredErrors: setup failed\n");
         err = 1;
+        goto done;
     }
-    xmlFree(string);
+    xmlCtxtSetErrorHandler(ctxt, testDeferredError, &deferred);
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST xml, "test.xml", NULL,
+                         XML_PARSE_RECOVER);
+    xmlFreeDoc(doc);
 
-    string = xmlTextReaderReadInnerXml(reader);
-    if (!xmlStrEqual(string, BAD_CAST "x<e>y</e><f>z</f>")) {
-        fprintf(stderr, "xmlTextReaderReadInnerXml failed\n");
+    n = normal.nbErrors;
+    if ((n < 4) || (n > 20) || (deferred.nbErrors != n) ||
+        (deferred.nbFormatted != 0)) {
+        fprintf(stderr, "testDeferredErrors: got %d/%d errors, "
+                "%d formatted\n", n, deferred.nbErrors,
+                deferred.nbFormatted);
         err = 1;
+        goto done;
     }
-    xmlFree(string);
 
-    string = xmlTextReaderReadString(reader);
-    if (!xmlStrEqual(string, BAD_CAST "xyz")) {
-        fprintf(stderr, "xmlTextReaderReadString failed\n");
+    for (i = 0; i < 3; i++) {
+        const char *expected = normal.messages[n - 1 - i];
+
+        if ((xmlCtxtGetDeferredError(ctxt, i, &rec) != 0) ||
+            (!xmlStrEqual(BAD_CAST rec.message, BAD_CAST expected)) ||
+            (!xmlStrEqual(BAD_CAST rec.file, BAD_CAST "test.xml"))) {
+            fprintf(stderr, "testDeferredErrors: error %d is \"%s\", "
+                    "expected \"%s\"\n", i,
+                    rec.message ? rec.message : "(null)", expected);
+            err = 1;
+        }
+        xmlResetError(&rec);
+    }
+    if (xmlCtxtGetDeferredError(ctxt, 3, &rec) != 1) {
+        fprintf(stderr, "testDeferredErrors: ring too large\n");
         err = 1;
     }
-    xmlFree(string);
 
-    xmlFreeTextReader(reader);
+    last = xmlCtxtGetLastError(ctxt);
+    if ((last == NULL) ||
+        (!xmlStrEqual(BAD_CAST last->message,
+                      BAD_CAST normal.messages[n - 1]))) {
+        fprintf(stderr, "testDeferredErrors: last error not formatted\n");
+        err = 1;
+    }
+
+    /* Turning deferred mode off formats messages again */
+    xmlCtxtSetDeferredErrors(ctxt, 0);
+    memset(&deferred, 0, sizeof(deferred));
+    xmlCtxtSetErrorHandler(ctxt, testDeferredError, &deferred);
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST xml, "test.xml", NULL,
+                         XML_PARSE_RECOVER);
+    xmlFreeDoc(doc);
+    if (deferred.nbFormatted != n) {
+        fprintf(stderr, "testDeferredErrors: messages missing\n");
+        err = 1;
+    }
+
+done:
+    for (i = 0; i < 20; i++) {
+        xmlFree(normal.messages[i]);
+        xmlFree(deferred.messages[i]);
+    }
+    xmlFreeParserCtxt(ctxt);
+
     return err;
 }
-#endif /* LIBXML_OUTPUT_ENABLED */
+
+typedef struct {
+    int count;
+    int firstCode;
+} testErrorPolicyData;
+
+static void
+testErrorPolicyError(void *vctxt, const xmlError *error) {
+    testErrorPolicyData *data = vctxt;
+
+    if (data->count == 0)
+        data->firstCode = error->code;
+    data->count += 1;
+}
 
 static int
-testReaderNode(xmlTextReader *reader) {
-    xmlChar *string;
-    int type;
+testErrorPolicy(void) {
+    const char *dup =
+        "<d><a x='1' x='2'/><a x='1' x='2'/><a x='1' x='2'/></d>";
+    testErrorPolicyData data;
+    xmlParserCtxt *ctxt;
+    xmlDoc *doc;
+    char buf[500];
+    int i;
     int err = 0;
 
-    type = xmlTextReaderNodeType(reader);
-    string = xmlTextReaderReadString(reader);
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetErrorHandler(ctxt, testErrorPolicyError, &data);
 
-    if (type == XML_READER_TYPE_ELEMENT) {
-        xmlNodePtr node = xmlTextReaderCurrentNode(reader);
+    /* Duplicate errors are only reported once but counted */
+    xmlCtxtSetErrorPolicy(ctxt, 0, 0, 1);
+    memset(&data, 0, sizeof(data));
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST dup, NULL, NULL, XML_PARSE_RECOVER);
+    xmlFreeDoc(doc);
+    if ((data.count != 1) ||
+        (xmlCtxtGetErrorCount(ctxt, XML_ERR_ATTRIBUTE_REDEFINED, 0) != 3) ||
+        (xmlCtxtGetErrorCount(ctxt, XML_ERR_ATTRIBUTE_REDEFINED, -1) != 3)) {
+        fprintf(stderr, "testErrorPolicy: dedup failed (%d reported)\n",
+                data.count);
+        err = 1;
+    }
 
-        if ((node->children == NULL) != (string == NULL))
-            err = 1;
-    } else if (type == XML_READER_TYPE_TEXT ||
-               type == XML_READER_TYPE_CDATA ||
-               type == XML_READER_TYPE_WHITESPACE ||
-               type == XML_READER_TYPE_SIGNIFICANT_WHITESPACE) {
-        if (string == NULL)
+    /* Parsing stops after the maximum number of errors */
+    xmlCtxtSetErrorPolicy(ctxt, 2, 0, 0);
+    memset(&data, 0, sizeof(data));
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST dup, NULL, NULL, XML_PARSE_RECOVER);
+    xmlFreeDoc(doc);
+    if ((data.count != 2) ||
+        (xmlCtxtGetErrorCount(ctxt, XML_ERR_ATTRIBUTE_REDEFINED, -1) != 2)) {
+        fprintf(stderr, "testErrorPolicy: parser didn't stop\n");
+        err = 1;
+    }
+
+    /* Removing the policy */
+    xmlCtxtSetErrorPolicy(ctxt, 0, 0, 0);
+    memset(&data, 0, sizeof(data));
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST dup, NULL, NULL, XML_PARSE_RECOVER);
+    xmlFreeDoc(doc);
+    if ((data.count != 3) ||
+        (xmlCtxtGetErrorCount(ctxt, XML_ERR_ATTRIBUTE_REDEFINED, -1) != 0)) {
+        fprintf(stderr, "testErrorPolicy: policy not removed\n");
+        err = 1;
+    }
+    xmlFreeParserCtxt(ctxt);
+
+    strcpy(buf, "<doc>");
+    for (i = 0; i < 50; i++)
+        strcat(buf, "<a>x</a>");
+    strcat(buf, "</doc>");
+    doc = xmlReadDoc(BAD_CAST buf, NULL, NULL, 0);
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+    {
+        const char *xsd =
+            "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+            "  <xs:element name='doc'>\n"
+            "    <xs:complexType>\n"
+            "      <xs:sequence>\n"
+            "        <xs:element name='a' type='xs:int'"
+            " maxOccurs='unbounded'/>\n"
+            "      </xs:sequence>\n"
+            "    </xs:complexType>\n"
+            "  </xs:element>\n"
+            "</xs:schema>\n";
+        xmlSchemaParserCtxtPtr pctxt;
+        xmlSchemaValidCtxtPtr vctxt;
+        xmlSchemaPtr schema;
+        int ret;
+
+        pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+        vctxt = xmlSchemaNewValidCtxt(schema);
+        xmlSchemaSetValidStructuredErrors(vctxt, testErrorPolicyError, &data);
+
+        xmlSchemaValidCtxtSetErrorPolicy(vctxt, 0, 5, 0);
+        memset(&data, 0, sizeof(data));
+        ret = xmlSchemaValidateDoc(vctxt, doc);
+        if ((ret <= 0) || (data.count != 5) ||
+            (xmlSchemaValidCtxtGetErrorCount(vctxt, data.firstCode,
+                                             XML_ELEMENT_NODE) != 50)) {
+            fprintf(stderr, "testErrorPolicy: schema limit per code "
+                    "failed\n");
             err = 1;
-    } else {
-        if (string != NULL)
+        }
+
+        /* Validation stops early */
+        xmlSchemaValidCtxtSetErrorPolicy(vctxt, 3, 0, 0);
+        memset(&data, 0, sizeof(data));
+        ret = xmlSchemaValidateDoc(vctxt, doc);
+        if ((ret <= 0) || (data.count != 3) ||
+            (xmlSchemaValidCtxtGetErrorCount(vctxt, data.firstCode,
+                                             -1) != 3)) {
+            fprintf(stderr, "testErrorPolicy: schema validation didn't "
+                    "stop\n");
             err = 1;
+        }
+
+        xmlSchemaFreeValidCtxt(vctxt);
+        xmlSchemaFree(schema);
     }
+#endif
 
-    if (err)
-        fprintf(stderr, "xmlTextReaderReadString failed for %d\n", type);
+#ifdef LIBXML_RELAXNG_ENABLED
+    {
+        const char *rng =
+            "<element name='doc'"
+            " xmlns='http://relaxng.org/ns/structure/1.0'\n"
+            "  datatypeLibrary='http://www.w3.org/2001/XMLSchema-datatypes'>"
+            "\n"
+            "  <zeroOrMore>\n"
+            "    <element name='a'><data type='int'/></element>\n"
+            "  </zeroOrMore>\n"
+            "</element>\n";
+        xmlRelaxNGParserCtxtPtr pctxt;
+        xmlRelaxNGValidCtxtPtr vctxt;
+        xmlRelaxNGPtr schema;
+        int ret;
+
+        pctxt = xmlRelaxNGNewMemParserCtxt(rng, strlen(rng));
+        schema = xmlRelaxNGParse(pctxt);
+        xmlRelaxNGFreeParserCtxt(pctxt);
+        vctxt = xmlRelaxNGNewValidCtxt(schema);
+        xmlRelaxNGSetValidStructuredErrors(vctxt, testErrorPolicyError,
+                                           &data);
+
+        xmlRelaxNGSetValidErrorPolicy(vctxt, 4, 0, 0);
+        memset(&data, 0, sizeof(data));
+        ret = xmlRelaxNGValidateDoc(vctxt, doc);
+        if ((ret <= 0) || (data.count != 4)) {
+            fprintf(stderr, "testErrorPolicy: Relax-NG limit failed\n");
+            err = 1;
+        }
 
-    xmlFree(string);
+        xmlRelaxNGFreeValidCtxt(vctxt);
+        xmlRelaxNGFree(schema);
+    }
+#endif
 
+    xmlFreeDoc(doc);
     return err;
 }
 
+static void
+testCtxtPoolError(void *vctxt, const xmlError *error ATTRIBUTE_UNUSED) {
+    int *count = vctxt;
+
+    *count += 1;
+}
+
 static int
-testReader(void) {
-    xmlTextReader *reader;
-    const xmlChar *xml = BAD_CAST
-        "<d>\n"
-        "  x<e a='v'>y</e><f>z</f>\n"
-        "  <![CDATA[cdata]]>\n"
-        "  <!-- comment -->\n"
-        "  <?pi content?>\n"
-        "  <empty/>\n"
-        "</d>";
+testCtxtPool(void) {
+    const char *xml =
+        "<a:doc xmlns:a='urn:a' xmlns:b='urn:b' x='1' y='2' z='3'>\n"
+        "  <b:e b:u='4' b:v='5' b:w='6'/>\n"
+        "</a:doc>\n";
+    const char *bad = "<doc><unclosed></doc>";
+    xmlParserCtxtPool *pool;
+    xmlParserCtxtPtr ctxt, ctxt2;
+    xmlDocPtr doc;
+    int errors = 0;
+    int i;
     int err = 0;
 
-    reader = xmlReaderForDoc(xml, NULL, NULL, 0);
+    pool = xmlNewParserCtxtPool(1);
 
-    while (xmlTextReaderRead(reader) > 0) {
-        if (testReaderNode(reader) > 0) {
+    ctxt = xmlParserCtxtPoolAcquire(pool);
+    xmlCtxtSetErrorHandler(ctxt, testCtxtPoolError, &errors);
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST bad, NULL, NULL, XML_PARSE_RECOVER);
+    if ((doc == NULL) || (errors == 0)) {
+        fprintf(stderr, "testCtxtPool: recovery failed\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+    xmlParserCtxtPoolRelease(pool, ctxt);
+
+    for (i = 0; i < 3; i++) {
+        ctxt2 = xmlParserCtxtPoolAcquire(pool);
+        if (ctxt2 != ctxt) {
+            fprintf(stderr, "testCtxtPool: context wasn't reused\n");
+            err = 1;
+        }
+        if ((xmlCtxtGetOptions(ctxt2) & XML_PARSE_RECOVER) ||
+            (xmlCtxtGetStatus(ctxt2) != 0)) {
+            fprintf(stderr, "testCtxtPool: context wasn't reset\n");
             err = 1;
-            break;
         }
 
-        if (xmlTextReaderMoveToFirstAttribute(reader) > 0) {
-            do {
-                if (testReaderNode(reader) > 0) {
-                    err = 1;
-                    break;
-                }
-            } while (xmlTextReaderMoveToNextAttribute(reader) > 0);
-
-            xmlTextReaderMoveToElement(reader);
+        doc = xmlCtxtReadDoc(ctxt2, BAD_CAST xml, NULL, NULL, 0);
+        if ((doc == NULL) ||
+            (xmlDocGetRootElement(doc)->ns == NULL) ||
+            (!xmlStrEqual(xmlDocGetRootElement(doc)->ns->href,
+                          BAD_CAST "urn:a"))) {
+            fprintf(stderr, "testCtxtPool: parsing failed\n");
+            err = 1;
+        }
+        xmlFreeDoc(doc);
+
+        /* The error handler must have been cleared */
+        errors = 0;
+        doc = xmlCtxtReadDoc(ctxt2, BAD_CAST bad, NULL, NULL,
+                             XML_PARSE_NOERROR);
+        if ((doc != NULL) || (errors != 0)) {
+            fprintf(stderr, "testCtxtPool: unexpected result\n");
+            err = 1;
         }
+        xmlFreeDoc(doc);
+
+        xmlParserCtxtPoolRelease(pool, ctxt2);
     }
 
-    xmlFreeTextReader(reader);
+    /* The pool is full, so this context is freed */
+    ctxt = xmlParserCtxtPoolAcquire(pool);
+    ctxt2 = xmlParserCtxtPoolAcquire(pool);
+    xmlParserCtxtPoolRelease(pool, ctxt);
+    xmlParserCtxtPoolRelease(pool, ctxt2);
+
+    xmlFreeParserCtxtPool(pool);
+
     return err;
 }
 
-#ifdef LIBXML_XINCLUDE_ENABLED
 typedef struct {
-    char *message;
-    int code;
-} testReaderErrorCtxt;
+    xmlMutex *lock;
+    int count;
+} testPoolCounter;
 
 static void
-testReaderError(void *arg, const char *msg,
-                xmlParserSeverities severity ATTRIBUTE_UNUSED,
-                xmlTextReaderLocatorPtr locator ATTRIBUTE_UNUSED) {
-    testReaderErrorCtxt *ctxt = arg;
+testPoolIncrement(void *arg) {
+    testPoolCounter *counter = arg;
 
-    if (ctxt->message != NULL)
-        xmlFree(ctxt->message);
-    ctxt->message = xmlMemStrdup(msg);
+    xmlMutexLock(counter->lock);
+    counter->count += 1;
+    xmlMutexUnlock(counter->lock);
 }
 
 static void
-testStructuredReaderError(void *arg, const xmlError *error) {
-    testReaderErrorCtxt *ctxt = arg;
+testPoolNested(void *arg) {
+    xmlTaskGroup *group = xmlNewTaskGroup();
+    int i;
 
-    if (ctxt->message != NULL)
-        xmlFree(ctxt->message);
-    ctxt->message = xmlMemStrdup(error->message);
-    ctxt->code = error->code;
+    for (i = 0; i < 10; i++)
+        xmlTaskGroupSubmit(group, testPoolIncrement, arg);
+    xmlFreeTaskGroup(group);
 }
 
+typedef struct {
+    xmlTaskFunc funcs[20];
+    void *args[20];
+    int nbTasks;
+} testPoolExecutor;
+
 static int
-testReaderXIncludeError(void) {
-    /*
-     * Test whether XInclude errors are reported to the custom error
-     * handler of a reader.
-     */
-    const char *doc =
-        "<doc xmlns:xi='http://www.w3.org/2001/XInclude'>\n"
-        "  <xi:include/>\n"
-        "</doc>\n";
-    xmlTextReader *reader;
-    testReaderErrorCtxt errorCtxt;
+testPoolSubmit(void *data, xmlTaskFunc func, void *arg) {
+    testPoolExecutor *executor = data;
+
+    if (executor->nbTasks >= 20)
+        return(-1);
+    executor->funcs[executor->nbTasks] = func;
+    executor->args[executor->nbTasks] = arg;
+    executor->nbTasks += 1;
+    return(0);
+}
+
+static int
+testThreadPool(void) {
+    testPoolExecutor executor;
+    testPoolCounter counter;
+    xmlTaskGroup *group;
+    int size, i;
     int err = 0;
 
-    reader = xmlReaderForDoc(BAD_CAST doc, NULL, NULL, XML_PARSE_XINCLUDE);
-    xmlTextReaderSetErrorHandler(reader, testReaderError, &errorCtxt);
-    errorCtxt.message = NULL;
-    errorCtxt.code = 0;
-    while (xmlTextReaderRead(reader) > 0)
-        ;
+    counter.lock = xmlNewMutex();
 
-    if (errorCtxt.message == NULL ||
-        strstr(errorCtxt.message, "href or xpointer") == NULL) {
-        fprintf(stderr, "xmlTextReaderSetErrorHandler failed\n");
-        err = 1;
-    }
+    for (size = 0; size <= 4; size += 4) {
+        xmlThreadPoolSetSize(size);
 
-    xmlFree(errorCtxt.message);
-    xmlFreeTextReader(reader);
+        counter.count = 0;
+        group = xmlNewTaskGroup();
+        for (i = 0; i < 1000; i++)
+            xmlTaskGroupSubmit(group, testPoolIncrement, &counter);
+        xmlTaskGroupJoin(group);
+        if (counter.count != 1000) {
+            fprintf(stderr, "testThreadPool: %d tasks with %d workers\n",
+                    counter.count, size);
+            err = 1;
+        }
 
-    reader = xmlReaderForDoc(BAD_CAST doc, NULL, NULL, XML_PARSE_XINCLUDE);
-    xmlTextReaderSetStructuredErrorHandler(reader, testStructuredReaderError,
-                                           &errorCtxt);
-    errorCtxt.message = NULL;
-    errorCtxt.code = 0;
-    while (xmlTextReaderRead(reader) > 0)
-        ;
+        /* Groups can be reused and joined from tasks */
+        counter.count = 0;
+        for (i = 0; i < 50; i++)
+            xmlTaskGroupSubmit(group, testPoolNested, &counter);
+        xmlFreeTaskGroup(group);
+        if (counter.count != 500) {
+            fprintf(stderr, "testThreadPool: %d nested tasks with %d "
+                    "workers\n", counter.count, size);
+            err = 1;
+        }
+    }
 
-    if (errorCtxt.code != XML_XINCLUDE_NO_HREF ||
-        errorCtxt.message == NULL ||
-        strstr(errorCtxt.message, "href or xpointer") == NULL) {
-        fprintf(stderr, "xmlTextReaderSetStructuredErrorHandler failed\n");
+    /*
+     * Tasks which the executor didn't run yet are run when joining,
+     * tasks it rejected as well.
+     */
+    memset(&executor, 0, sizeof(executor));
+    xmlThreadPoolSetExecutor(testPoolSubmit, &executor);
+    counter.count = 0;
+    group = xmlNewTaskGroup();
+    for (i = 0; i < 30; i++)
+        xmlTaskGroupSubmit(group, testPoolIncrement, &counter);
+    for (i = 0; i < 10; i++)
+        executor.funcs[i](executor.args[i]);
+    if (counter.count != 10) {
+        fprintf(stderr, "testThreadPool: executor ran %d tasks\n",
+                counter.count);
         err = 1;
     }
+    xmlFreeTaskGroup(group);
+    for (i = 10; i < executor.nbTasks; i++)
+        executor.funcs[i](executor.args[i]);
+    if ((executor.nbTasks != 20) || (counter.count != 30)) {
+        fprintf(stderr, "testThreadPool: %d tasks with executor\n",
+                counter.count);
+        err = 1;
+    }
+    xmlThreadPoolSetExecutor(NULL, NULL);
 
-    xmlFree(errorCtxt.message);
-    xmlFreeTextReader(reader);
+    if ((xmlThreadPoolSetSize(-1) != -1) ||
+        (xmlTaskGroupSubmit(NULL, testPoolIncrement, NULL) != -1)) {
+        fprintf(stderr, "testThreadPool: invalid arguments accepted\n");
+        err = 1;
+    }
+
+    xmlThreadPoolSetSize(4);
+    xmlFreeMutex(counter.lock);
+
+    return(err);
+}
+
+static void
+testReadBatchStore(void *data, int index, xmlDoc *doc,
+                   const xmlError *error ATTRIBUTE_UNUSED) {
+    xmlDocPtr *docs = data;
+
+    docs[index] = doc;
+}
+
+static int
+testReadBatch(void) {
+    xmlBatchItem items[40];
+    xmlDocPtr docs[40];
+    char bufs[40][100];
+    xmlDictPtr dict;
+    const xmlChar *name;
+    int i, ret;
+    int err = 0;
+
+    dict = xmlDictCreate();
+    name = xmlDictLookup(dict, BAD_CAST "item", -1);
+
+    for (i = 0; i < 40; i++) {
+        memset(&items[i], 0, sizeof(items[i]));
+        if (i == 37) {
+            items[i].filename = "test/att1";
+            continue;
+        }
+        if (i == 38)
+            snprintf(bufs[i], sizeof(bufs[i]), "<item><unclosed></item>");
+        else
+            snprintf(bufs[i], sizeof(bufs[i]), "<item n='%d'><x/></item>", i);
+        items[i].buffer = bufs[i];
+        items[i].size = strlen(bufs[i]);
+    }
+
+    ret = xmlReadBatch(items, 40, dict, NULL, XML_PARSE_NOERROR, NULL, NULL);
+    if (ret != 39) {
+        fprintf(stderr, "testReadBatch: parsed %d documents\n", ret);
+        err = 1;
+    }
+    for (i = 0; i < 40; i++) {
+        xmlNodePtr root = xmlDocGetRootElement(items[i].doc);
+        char num[20];
+        xmlChar *n;
+
+        if (i == 38) {
+            if ((items[i].doc != NULL) ||
+                (items[i].error != XML_ERR_TAG_NAME_MISMATCH)) {
+                fprintf(stderr, "testReadBatch: unexpected result\n");
+                err = 1;
+            }
+            continue;
+        }
+        if ((root == NULL) || (items[i].error != XML_ERR_OK)) {
+            fprintf(stderr, "testReadBatch: item %d failed\n", i);
+            err = 1;
+            continue;
+        }
+        if (i == 37) {
+            if (!xmlStrEqual(root->name, BAD_CAST "doc")) {
+                fprintf(stderr, "testReadBatch: wrong file\n");
+                err = 1;
+            }
+            continue;
+        }
+
+        /* Names in the shared dictionary aren't copied */
+        n = xmlGetProp(root, BAD_CAST "n");
+        snprintf(num, sizeof(num), "%d", i);
+        if ((root->name != name) || (!xmlStrEqual(n, BAD_CAST num))) {
+            fprintf(stderr, "testReadBatch: wrong document %d\n", i);
+            err = 1;
+        }
+        xmlFree(n);
+    }
+    for (i = 0; i < 40; i++)
+        xmlFreeDoc(items[i].doc);
+
+    /* The shared dictionary was frozen */
+    if (xmlDictLookup(dict, BAD_CAST "new", -1) != NULL) {
+        fprintf(stderr, "testReadBatch: dictionary not frozen\n");
+        err = 1;
+    }
+
+    memset(docs, 0, sizeof(docs));
+    ret = xmlReadBatch(items, 37, NULL, NULL, 0, testReadBatchStore, docs);
+    for (i = 0; i < 37; i++) {
+        if ((items[i].doc != NULL) || (docs[i] == NULL)) {
+            fprintf(stderr, "testReadBatch: callback not invoked\n");
+            err = 1;
+        }
+        xmlFreeDoc(docs[i]);
+    }
+    if ((ret != 37) ||
+        (xmlReadBatch(NULL, 1, NULL, NULL, 0, NULL, NULL) != -1)) {
+        fprintf(stderr, "testReadBatch: wrong return value\n");
+        err = 1;
+    }
+
+    xmlDictFree(dict);
+    return err;
+}
+
+typedef struct {
+    int counts[XML_TRACE_SAVE_FLUSH + 1];
+    long docBytes;
+    int badDuration;
+} testTraceData;
+
+static void
+testTraceHandler(void *vdata, const xmlTraceInfo *info) {
+    testTraceData *data = vdata;
+
+    if ((info->event < 1) || (info->event > XML_TRACE_SAVE_FLUSH))
+        return;
+    data->counts[info->event] += 1;
+    if (info->event == XML_TRACE_DOC_END)
+        data->docBytes = info->bytes;
+    if (info->duration < 0.0)
+        data->badDuration = 1;
+}
+
+static int
+testTrace(void) {
+    const char docContent[] = "<doc><a>1</a><a>2</a></doc>";
+    testTraceData data;
+    xmlDocPtr doc;
+    int err = 0;
+
+    memset(&data, 0, sizeof(data));
+    xmlTraceSetHandler(testTraceHandler, &data);
+
+    doc = xmlReadMemory(docContent, sizeof(docContent) - 1, "test.xml",
+                        NULL, 0);
+#ifdef LIBXML_XPATH_ENABLED
+    {
+        xmlXPathContextPtr ctxt = xmlXPathNewContext(doc);
+        xmlXPathCompExprPtr comp = xmlXPathCompile(BAD_CAST "//a");
+
+        xmlXPathFreeObject(xmlXPathCompiledEval(comp, ctxt));
+        xmlXPathFreeObject(xmlXPathEval(BAD_CAST "count(//a)", ctxt));
+        xmlXPathFreeCompExpr(comp);
+        xmlXPathFreeContext(ctxt);
+    }
+#endif
+#ifdef LIBXML_OUTPUT_ENABLED
+    {
+        xmlBufferPtr buf = xmlBufferCreate();
+        xmlSaveCtxtPtr save = xmlSaveToBuffer(buf, NULL, 0);
+
+        xmlSaveDoc(save, doc);
+        xmlSaveClose(save);
+        xmlBufferFree(buf);
+    }
+#endif
+    xmlFreeDoc(doc);
+
+    xmlTraceSetHandler(NULL, NULL);
+    /* No events after the handler was removed */
+    xmlFreeDoc(xmlReadMemory(docContent, sizeof(docContent) - 1,
+                             "test.xml", NULL, 0));
+
+    if ((data.counts[XML_TRACE_DOC_START] != 1) ||
+        (data.counts[XML_TRACE_DOC_END] != 1) ||
+        (data.docBytes != (long) sizeof(docContent) - 1)) {
+        fprintf(stderr, "testTrace: document events %d/%d, %ld bytes\n",
+                data.counts[XML_TRACE_DOC_START],
+                data.counts[XML_TRACE_DOC_END], data.docBytes);
+        err = 1;
+    }
+#ifdef LIBXML_XPATH_ENABLED
+    if ((data.counts[XML_TRACE_XPATH_COMPILE] != 1) ||
+        (data.counts[XML_TRACE_XPATH_EVAL] != 2)) {
+        fprintf(stderr, "testTrace: XPath events %d/%d\n",
+                data.counts[XML_TRACE_XPATH_COMPILE],
+                data.counts[XML_TRACE_XPATH_EVAL]);
+        err = 1;
+    }
+#endif
+#ifdef LIBXML_OUTPUT_ENABLED
+    if (data.counts[XML_TRACE_SAVE_FLUSH] < 1) {
+        fprintf(stderr, "testTrace: no save flush events\n");
+        err = 1;
+    }
+#endif
+    if (data.badDuration) {
+        fprintf(stderr, "testTrace: negative duration\n");
+        err = 1;
+    }
+
+    return(err);
+}
+
+static int
+testCtxtStats(void) {
+    const char docContent[] =
+        "<!DOCTYPE doc [<!ENTITY e 'ent'>]>\n"
+        "<doc xmlns='urn:a' xmlns:b='urn:b'>"
+        "<b:x a='1' b='2'>&e;</b:x><y><z/></y><y/>"
+        "</doc>";
+    const char latin1Content[] =
+        "<?xml version='1.0' encoding='ISO-8859-1'?>\n"
+        "<doc>\xE9\xE9</doc>";
+    xmlParserCtxtPtr ctxt;
+    xmlParserStats stats;
+    xmlDocPtr doc;
+    int err = 0;
+
+    ctxt = xmlNewParserCtxt();
+    doc = xmlCtxtReadMemory(ctxt, docContent, sizeof(docContent) - 1,
+                            NULL, NULL, XML_PARSE_NOENT);
+    xmlFreeDoc(doc);
+    xmlCtxtGetStats(ctxt, &stats);
+
+    /* doctype, doc, x, text, y, z, y */
+    if ((stats.nodes != 7) || (stats.attributes != 2) ||
+        (stats.namespaces != 2) || (stats.maxDepth != 3)) {
+        fprintf(stderr, "testCtxtStats: %lu nodes, %lu attributes, "
+                "%lu namespaces, depth %d\n", stats.nodes,
+                stats.attributes, stats.namespaces, stats.maxDepth);
+        err = 1;
+    }
+    if ((stats.bytesRead != sizeof(docContent) - 1) ||
+        (stats.bytesDecoded < stats.bytesRead)) {
+        fprintf(stderr, "testCtxtStats: %lu bytes read, %lu decoded\n",
+                stats.bytesRead, stats.bytesDecoded);
+        err = 1;
+    }
+    if ((stats.entityExpansions < 1) || (stats.entityBytes < 3) ||
+        (stats.amplification <= 0.0)) {
+        fprintf(stderr, "testCtxtStats: %lu expansions, %lu bytes\n",
+                stats.entityExpansions, stats.entityBytes);
+        err = 1;
+    }
+    /* "y" is looked up three times, but only inserted once */
+    if ((stats.dictInserts == 0) || (stats.dictHits < 2)) {
+        fprintf(stderr, "testCtxtStats: %lu dict hits, %lu inserts\n",
+                stats.dictHits, stats.dictInserts);
+        err = 1;
+    }
+
+    xmlCtxtSetStatsTiming(ctxt, 1);
+    doc = xmlCtxtReadMemory(ctxt, latin1Content, sizeof(latin1Content) - 1,
+                            NULL, NULL, 0);
+    xmlFreeDoc(doc);
+    xmlCtxtGetStats(ctxt, &stats);
+
+    /* Two Latin-1 bytes decode to four bytes of UTF-8 */
+    if ((stats.bytesRead != sizeof(latin1Content) - 1) ||
+        (stats.bytesDecoded != stats.bytesRead + 2) ||
+        (stats.nodes != 2) || (stats.encodingTime < 0.0)) {
+        fprintf(stderr, "testCtxtStats: encoded input: %lu bytes read, "
+                "%lu decoded, %lu nodes\n", stats.bytesRead,
+                stats.bytesDecoded, stats.nodes);
+        err = 1;
+    }
+
+    xmlFreeParserCtxt(ctxt);
+
+    return(err);
+}
+
+#ifdef LIBXML_VALID_ENABLED
+static void
+testSwitchDtdExtSubset(void *vctxt, const xmlChar *name ATTRIBUTE_UNUSED,
+                       const xmlChar *externalId ATTRIBUTE_UNUSED,
+                       const xmlChar *systemId ATTRIBUTE_UNUSED) {
+    xmlParserCtxtPtr ctxt = vctxt;
+
+    ctxt->myDoc->extSubset = ctxt->_private;
+}
+
+static int
+testSwitchDtd(void) {
+    const char dtdContent[] =
+        "<!ENTITY test '<elem1/><elem2/>'>\n";
+    const char docContent[] =
+        "<!DOCTYPE doc SYSTEM 'entities.dtd'>\n"
+        "<doc>&test;</doc>\n";
+    xmlParserInputBufferPtr input;
+    xmlParserCtxtPtr ctxt;
+    xmlDtdPtr dtd;
+    xmlDocPtr doc;
+    xmlEntityPtr ent;
+    int err = 0;
+
+    input = xmlParserInputBufferCreateStatic(dtdContent,
+                                             sizeof(dtdContent) - 1,
+                                             XML_CHAR_ENCODING_NONE);
+    dtd = xmlIOParseDTD(NULL, input, XML_CHAR_ENCODING_NONE);
+
+    ctxt = xmlNewParserCtxt();
+    ctxt->_private = dtd;
+    ctxt->sax->externalSubset = testSwitchDtdExtSubset;
+    doc = xmlCtxtReadMemory(ctxt, docContent, sizeof(docContent) - 1, NULL,
+                            NULL, XML_PARSE_NOENT | XML_PARSE_DTDLOAD);
+    xmlFreeParserCtxt(ctxt);
+
+    ent = xmlGetDocEntity(doc, BAD_CAST "test");
+    if (ent->children->doc != NULL) {
+        fprintf(stderr, "Entity content should have NULL doc\n");
+        err = 1;
+    }
+
+    /* Free doc before DTD */
+    doc->extSubset = NULL;
+    xmlFreeDoc(doc);
+    xmlFreeDtd(dtd);
+
+    return err;
+}
+
+static void
+testSharedDtdError(void *vctxt, const xmlError *error ATTRIBUTE_UNUSED) {
+    int *count = vctxt;
+
+    *count += 1;
+}
+
+static xmlDocPtr
+testSharedDtdParse(const char *content, int options, int *valid,
+                   int *errors) {
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetErrorHandler(ctxt, testSharedDtdError, errors);
+    doc = xmlCtxtReadMemory(ctxt, content, strlen(content), NULL, NULL,
+                            options);
+    *valid = ctxt->valid;
+    xmlFreeParserCtxt(ctxt);
+
+    return doc;
+}
+
+static int
+testSharedDtd(void) {
+    const char dtdContent[] =
+        "<!ELEMENT doc (item+)>\n"
+        "<!ELEMENT item (#PCDATA)>\n"
+        "<!ATTLIST item type CDATA 'plain'>\n"
+        "<!ENTITY name 'World'>\n"
+        "<!ENTITY greeting 'Hello &name;'>\n"
+        "<!ENTITY markup '<item>&name;</item>'>\n";
+    const char validDoc[] =
+        "<!DOCTYPE doc SYSTEM 'shared.dtd'>\n"
+        "<doc><item>&greeting;</item>&markup;</doc>\n";
+    const char invalidDoc[] =
+        "<!DOCTYPE doc PUBLIC '-//TEST//Shared' 'other.dtd'>\n"
+        "<doc><other/></doc>\n";
+    const char refDoc[] =
+        "<!DOCTYPE doc SYSTEM 'shared.dtd'>\n"
+        "<doc><item type='&name;'>&greeting;</item></doc>\n";
+    int options = XML_PARSE_DTDVALID | XML_PARSE_DTDATTR;
+    xmlParserInputBufferPtr input;
+    xmlDtdPtr dtd;
+    xmlDocPtr doc1, doc2, doc3;
+    xmlChar *content;
+    int valid, errors = 0;
+    int err = 0;
+
+    input = xmlParserInputBufferCreateStatic(dtdContent,
+                                             sizeof(dtdContent) - 1,
+                                             XML_CHAR_ENCODING_NONE);
+    dtd = xmlIOParseDTD(NULL, input, XML_CHAR_ENCODING_NONE);
+    if (xmlDtdCacheAdd(dtd, BAD_CAST "-//TEST//Shared",
+                       BAD_CAST "shared.dtd") != 0) {
+        fprintf(stderr, "xmlDtdCacheAdd failed\n");
+        return 1;
+    }
+
+    doc1 = testSharedDtdParse(validDoc, options | XML_PARSE_NOENT,
+                              &valid, &errors);
+    if ((doc1 == NULL) || (doc1->extSubset != dtd) || (!valid) ||
+        (errors != 0)) {
+        fprintf(stderr, "Shared DTD not used for valid document\n");
+        err = 1;
+    } else {
+        xmlNodePtr item = doc1->children->next->children;
+
+        content = xmlGetProp(item, BAD_CAST "type");
+        if (!xmlStrEqual(content, BAD_CAST "plain")) {
+            fprintf(stderr, "Wrong default attribute: %s\n", content);
+            err = 1;
+        }
+        xmlFree(content);
+
+        content = xmlNodeGetContent(doc1->children->next);
+        if (!xmlStrEqual(content, BAD_CAST "Hello WorldWorld")) {
+            fprintf(stderr, "Wrong expanded content: %s\n", content);
+            err = 1;
+        }
+        xmlFree(content);
+    }
+
+    /* Looked up by public ID */
+    doc2 = testSharedDtdParse(invalidDoc, options, &valid, &errors);
+    if ((doc2 == NULL) || (doc2->extSubset != dtd) || (valid) ||
+        (errors == 0)) {
+        fprintf(stderr, "Invalid document not detected with shared DTD\n");
+        err = 1;
+    }
+
+    /* Entity references aren't substituted */
+    doc3 = testSharedDtdParse(refDoc, options, &valid, &errors);
+    if ((doc3 == NULL) || (doc3->extSubset != dtd) || (!valid)) {
+        fprintf(stderr, "Shared DTD not used for entity references\n");
+        err = 1;
+    } else {
+        xmlNodePtr item = doc3->children->next->children;
+
+        content = xmlGetProp(item, BAD_CAST "type");
+        if (!xmlStrEqual(content, BAD_CAST "World")) {
+            fprintf(stderr, "Wrong attribute value: %s\n", content);
+            err = 1;
+        }
+        xmlFree(content);
+
+        content = xmlNodeGetContent(item);
+        if (!xmlStrEqual(content, BAD_CAST "Hello World")) {
+            fprintf(stderr, "Wrong entity content: %s\n", content);
+            err = 1;
+        }
+        xmlFree(content);
+    }
+
+    /* Documents keep the DTD alive after clearing the cache */
+    xmlDtdCacheClear();
+    xmlFreeDoc(doc1);
+    xmlFreeDoc(doc2);
+
+    errors = 0;
+    doc1 = testSharedDtdParse(validDoc, options, &valid, &errors);
+    if ((doc1 == NULL) || (doc1->extSubset != NULL) || (errors == 0)) {
+        fprintf(stderr, "Shared DTD used after clearing the cache\n");
+        err = 1;
+    }
+
+    xmlFreeDoc(doc1);
+    xmlFreeDoc(doc3);
+
+    return err;
+}
+
+static int
+testLazyIds(void) {
+    const char docContent[] =
+        "<!DOCTYPE doc [\n"
+        "<!ATTLIST item id ID #IMPLIED ref IDREF #IMPLIED>\n"
+        "]>\n"
+        "<doc>\n"
+        "  <item id='a'/>\n"
+        "  <item id='b' ref='a'/>\n"
+        "  <item id='a' ref='a'/>\n"
+        "  <other xml:id='c'/>\n"
+        "</doc>\n";
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlAttrPtr attr;
+    xmlListPtr refs;
+    int err = 0;
+
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetLazyIds(ctxt, 1);
+    doc = xmlCtxtReadMemory(ctxt, docContent, sizeof(docContent) - 1,
+                            NULL, NULL, 0);
+    xmlFreeParserCtxt(ctxt);
+
+    if (doc->ids != NULL) {
+        fprintf(stderr, "ID table built while parsing with lazy IDs\n");
+        err = 1;
+    }
+
+    attr = xmlGetID(doc, BAD_CAST "a");
+    if ((attr == NULL) || (attr->parent->prev->prev != NULL)) {
+        fprintf(stderr, "Wrong element for lazy ID\n");
+        err = 1;
+    }
+    if (xmlGetID(doc, BAD_CAST "c") == NULL) {
+        fprintf(stderr, "Lazy xml:id not found\n");
+        err = 1;
+    }
+
+    refs = xmlGetRefs(doc, BAD_CAST "a");
+    if (xmlListSize(refs) != 2) {
+        fprintf(stderr, "Expected 2 refs, got %d\n", xmlListSize(refs));
+        err = 1;
+    }
+    xmlRemoveRef(doc, xmlHasProp(attr->parent->next->next, BAD_CAST "ref"));
+    if (xmlListSize(refs) != 1) {
+        fprintf(stderr, "Ref list not updated after removal\n");
+        err = 1;
+    }
+
+    xmlFreeDoc(doc);
+    return err;
+}
+
+static int
+testContentModelNames(void) {
+    const char docContent[] =
+        "<!DOCTYPE doc [\n"
+        "<!ELEMENT doc (head, (a|b|c)*, tail?)>\n"
+        "<!ELEMENT head EMPTY>\n"
+        "<!ELEMENT a EMPTY>\n"
+        "<!ELEMENT b EMPTY>\n"
+        "<!ELEMENT c EMPTY>\n"
+        "<!ELEMENT tail EMPTY>\n"
+        "]>\n"
+        "<doc><head/><a/><c/><b/><a/><tail/></doc>\n";
+    const int options[] = { 0, XML_PARSE_NODICT };
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlNodePtr tail;
+    int err = 0;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        ctxt = xmlNewParserCtxt();
+        doc = xmlCtxtReadMemory(ctxt, docContent, sizeof(docContent) - 1,
+                                NULL, NULL,
+                                options[i] | XML_PARSE_DTDVALID |
+                                XML_PARSE_NOERROR);
+        if ((doc == NULL) || (!ctxt->valid)) {
+            fprintf(stderr, "Valid content rejected (options %d)\n",
+                    options[i]);
+            err = 1;
+        }
+
+        /* Tree validation */
+        tail = xmlDocGetRootElement(doc)->last;
+        xmlAddNextSibling(tail, xmlNewDocNode(doc, NULL, BAD_CAST "b", NULL));
+        if (xmlCtxtValidateDocument(ctxt, doc) != 0) {
+            fprintf(stderr, "Misplaced child accepted (options %d)\n",
+                    options[i]);
+            err = 1;
+        }
+        xmlUnlinkNode(tail);
+        xmlFreeNode(tail);
+        if (xmlCtxtValidateDocument(ctxt, doc) != 1) {
+            fprintf(stderr, "Valid tree rejected (options %d)\n",
+                    options[i]);
+            err = 1;
+        }
+
+        xmlFreeDoc(doc);
+        xmlFreeParserCtxt(ctxt);
+    }
+
+    return err;
+}
+
+static int
+testDtdDeclLookup(void) {
+    xmlBufferPtr buf;
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlDtdPtr ext;
+    char name[20];
+    char tag[40];
+    int err = 0;
+    int i;
+
+    /*
+     * Attributes of undeclared elements create placeholders in the
+     * internal subset which are removed when the elements are
+     * declared in the external subset.
+     */
+    buf = xmlBufferCreate();
+    xmlBufferCCat(buf, "<!DOCTYPE doc [\n<!ELEMENT doc (");
+    for (i = 0; i < 40; i++) {
+        snprintf(name, sizeof(name), "%se%d", i ? "|" : "", i);
+        xmlBufferCCat(buf, name);
+    }
+    xmlBufferCCat(buf, ")*>\n");
+    for (i = 0; i < 40; i++) {
+        snprintf(name, sizeof(name), "e%d", i);
+        xmlBufferCCat(buf, "<!ATTLIST ");
+        xmlBufferCCat(buf, name);
+        xmlBufferCCat(buf, " v CDATA #IMPLIED>\n");
+    }
+    xmlBufferCCat(buf, "]>\n<doc>");
+    for (i = 0; i < 40; i++) {
+        snprintf(tag, sizeof(tag), "<e%d v='1'/>", i);
+        xmlBufferCCat(buf, tag);
+    }
+    xmlBufferCCat(buf, "</doc>\n");
+
+    ctxt = xmlNewParserCtxt();
+    doc = xmlCtxtReadMemory(ctxt, (const char *) xmlBufferContent(buf),
+                            xmlBufferLength(buf), NULL, NULL, 0);
+    xmlBufferFree(buf);
+    if (doc == NULL) {
+        fprintf(stderr, "testDtdDeclLookup: parsing failed\n");
+        xmlFreeParserCtxt(ctxt);
+        return(1);
+    }
+    xmlCtxtSetErrorHandler(ctxt, ignoreError, NULL);
+    if (xmlCtxtValidateDocument(ctxt, doc) != 0) {
+        fprintf(stderr, "testDtdDeclLookup: undeclared elements accepted\n");
+        err = 1;
+    }
+
+    ext = xmlNewDtd(doc, BAD_CAST "doc", NULL, BAD_CAST "ext.dtd");
+    for (i = 0; i < 40; i += 2) {
+        snprintf(name, sizeof(name), "e%d", i);
+        xmlAddElementDecl(NULL, ext, BAD_CAST name, XML_ELEMENT_TYPE_EMPTY,
+                          NULL);
+    }
+    for (i = 0; i < 40; i++) {
+        snprintf(name, sizeof(name), "e%d", i);
+        if ((xmlGetDtdElementDesc(doc->intSubset, BAD_CAST name) == NULL) !=
+            (i % 2 == 0)) {
+            fprintf(stderr, "testDtdDeclLookup: wrong lookup of %s\n", name);
+            err = 1;
+        }
+    }
+    if (xmlCtxtValidateDocument(ctxt, doc) != 0) {
+        fprintf(stderr, "testDtdDeclLookup: undeclared elements accepted\n");
+        err = 1;
+    }
+
+    for (i = 1; i < 40; i += 2) {
+        snprintf(name, sizeof(name), "e%d", i);
+        xmlAddElementDecl(NULL, ext, BAD_CAST name, XML_ELEMENT_TYPE_EMPTY,
+                          NULL);
+    }
+    if (xmlCtxtValidateDocument(ctxt, doc) != 1) {
+        fprintf(stderr, "testDtdDeclLookup: valid document rejected\n");
+        err = 1;
+    }
+
+    xmlFreeDoc(doc);
+    xmlFreeParserCtxt(ctxt);
+
+    return(err);
+}
+#endif /* LIBXML_VALID_ENABLED */
+
+/*
+ * Records the namespace names of all references in a subtree or checks
+ * that the references still have the recorded names and that their
+ * prefixes are bound to these names in scope.
+ */
+static int
+checkNsRef(xmlNodePtr node, xmlNsPtr ns, const xmlChar **hrefs, int *nb,
+           int record) {
+    xmlNsPtr decl;
+    int err = 0;
+
+    if (record) {
+        hrefs[*nb] = ns ? ns->href : NULL;
+    } else if (ns != NULL) {
+        decl = xmlSearchNs(node->doc, node, ns->prefix);
+        if ((!xmlStrEqual(ns->href, hrefs[*nb])) ||
+            (decl == NULL) ||
+            (!xmlStrEqual(decl->href, ns->href)))
+            err = 1;
+    }
+    (*nb)++;
+
+    return(err);
+}
+
+static int
+checkNsRefs(xmlNodePtr node, const xmlChar **hrefs, int *nb, int record) {
+    xmlAttrPtr attr;
+    int err = 0;
+
+    for (; node != NULL; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE)
+            continue;
+        err |= checkNsRef(node, node->ns, hrefs, nb, record);
+        for (attr = node->properties; attr != NULL; attr = attr->next)
+            err |= checkNsRef(node, attr->ns, hrefs, nb, record);
+        err |= checkNsRefs(node->children, hrefs, nb, record);
+    }
+
+    return(err);
+}
+
+static int
+testReconcileNs(void) {
+    static const char src[] =
+        "<r xmlns:a='A' xmlns:b='B'>"
+        "<a:x b:at='1'><b:y xmlns:a='A2' a:at='2'><a:z/></b:y><a:w/></a:x>"
+        "</r>";
+    const xmlChar *hrefs[2000];
+    xmlDocPtr doc, dest;
+    xmlNodePtr root, moved, tmp;
+    int err = 0;
+    int i, nb, mode;
+
+    for (mode = 0; mode < 3; mode++) {
+        doc = xmlReadMemory(src, sizeof(src) - 1, NULL, NULL, 0);
+        root = xmlDocGetRootElement(doc);
+        for (i = 0; i < 100; i++) {
+            tmp = xmlCopyNode(root->children, 1);
+            xmlAddChild(root, tmp);
+        }
+        moved = root->children;
+        nb = 0;
+        checkNsRefs(moved, hrefs, &nb, 1);
+
+        dest = xmlReadMemory("<d xmlns:a='OTHER'><e xmlns:b='B'/></d>", 39,
+                             NULL, NULL, 0);
+        tmp = xmlDocGetRootElement(dest)->children;
+        while (root->children != NULL) {
+            moved = root->children;
+            xmlUnlinkNode(moved);
+            if ((mode == 2) &&
+                (xmlDOMWrapAdoptNode(NULL, doc, moved, dest, tmp, 0) < 0))
+                err = 1;
+            xmlAddChild(tmp, moved);
+        }
+
+        if (mode == 0) {
+            if (xmlReconciliateNs(dest, tmp) < 0)
+                err = 1;
+        } else if (mode == 1) {
+            if (xmlDOMWrapReconcileNamespaces(NULL, tmp, 0) < 0)
+                err = 1;
+        }
+
+        nb = 0;
+        if (checkNsRefs(tmp->children, hrefs, &nb, 0) != 0) {
+            fprintf(stderr, "testReconcileNs: wrong references in mode %d\n",
+                    mode);
+            err = 1;
+        }
+        xmlFreeDoc(dest);
+        xmlFreeDoc(doc);
+    }
+
+    return(err);
+}
+
+static int
+testNameChars(void) {
+    static const struct {
+        const char *input;
+        int valid;
+        int validOld10;
+    } tests[] = {
+        { "<\xE4\xB8\x80\xC2\xB7/>", 1, 1 },      /* U+4E00 U+00B7 */
+        { "<\xC2\xB7" "a/>", 0, 0 },              /* U+00B7 */
+        { "<a\xCD\xBE/>", 0, 0 },                 /* U+037E */
+        { "<a\xCD\xBF/>", 1, 0 },                 /* U+037F */
+        { "<\xE3\x80\x81/>", 1, 0 },              /* U+3001 */
+        { "<\xE3\x80\x87/>", 1, 1 },              /* U+3007 */
+        { "<\xF0\x90\x80\x80/>", 1, 0 },          /* U+10000 */
+        { "<\xE0\xB8\x81\xE0\xB8\xB1/>", 1, 1 },  /* U+0E01 U+0E31 */
+        { "<\xE0\xB8\xB1/>", 1, 0 }               /* U+0E31 */
+    };
+    int err = 0;
+    size_t i;
+    int old10;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        for (old10 = 0; old10 < 2; old10++) {
+            xmlDocPtr doc;
+            int valid = old10 ? tests[i].validOld10 : tests[i].valid;
+
+            doc = xmlReadMemory(tests[i].input, strlen(tests[i].input),
+                                NULL, "UTF-8",
+                                XML_PARSE_NOERROR |
+                                (old10 ? XML_PARSE_OLD10 : 0));
+            if ((doc != NULL) != valid) {
+                fprintf(stderr, "testNameChars: test %d %s with old10=%d\n",
+                        (int) i, valid ? "rejected" : "accepted", old10);
+                err = 1;
+            }
+            xmlFreeDoc(doc);
+        }
+    }
+
+    return(err);
+}
+
+static int
+testHashReserve(void) {
+    const xmlChar *names[4] = {
+        BAD_CAST "a", BAD_CAST "b", BAD_CAST "a", BAD_CAST "c"
+    };
+    void *items[4] = { names, names + 1, names + 2, names + 3 };
+    xmlHashTablePtr hash;
+    xmlDictPtr dict;
+    char name[20];
+    int err = 0;
+    int i, j;
+
+    hash = xmlHashCreate(0);
+    if (xmlHashReserve(hash, 10000) != 0) {
+        fprintf(stderr, "testHashReserve: reserve failed\n");
+        err = 1;
+    }
+    for (i = 0; i < 10000; i++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        xmlHashAdd(hash, BAD_CAST name, hash);
+    }
+    for (i = 0; i < 10000; i++) {
+        snprintf(name, sizeof(name), "n%d", i);
+        if (xmlHashLookup(hash, BAD_CAST name) != hash) {
+            fprintf(stderr, "testHashReserve: %s not found\n", name);
+            err = 1;
+            break;
+        }
+    }
+    xmlHashFree(hash, NULL);
+
+    hash = xmlHashCreate(0);
+    xmlHashAdd(hash, BAD_CAST "c", hash);
+    if (xmlHashAddEntries(hash, 4, names, items) != 2) {
+        fprintf(stderr, "testHashReserve: wrong number of entries added\n");
+        err = 1;
+    }
+    if ((xmlHashSize(hash) != 3) ||
+        (xmlHashLookup(hash, BAD_CAST "a") != items[0]) ||
+        (xmlHashLookup(hash, BAD_CAST "b") != items[1]) ||
+        (xmlHashLookup(hash, BAD_CAST "c") != hash)) {
+        fprintf(stderr, "testHashReserve: wrong entries after bulk add\n");
+        err = 1;
+    }
+    xmlHashFree(hash, NULL);
+
+    for (i = 0; i < 2; i++) {
+        dict = (i == 0) ? xmlDictCreate() : xmlDictCreateConcurrent();
+        if (xmlDictReserve(dict, 5000) != 0) {
+            fprintf(stderr, "testHashReserve: dict reserve failed\n");
+            err = 1;
+        }
+        for (j = 0; j < 5000; j++) {
+            snprintf(name, sizeof(name), "n%d", j);
+            xmlDictLookup(dict, BAD_CAST name, -1);
+        }
+        if (xmlDictSize(dict) != 5000) {
+            fprintf(stderr, "testHashReserve: wrong dict size\n");
+            err = 1;
+        }
+        xmlDictFreeze(dict);
+        if (xmlDictReserve(dict, 10000) != -1) {
+            fprintf(stderr, "testHashReserve: frozen dict resized\n");
+            err = 1;
+        }
+        xmlDictFree(dict);
+    }
+
+    return(err);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static xmlChar *
+dumpNodeList(xmlNodePtr list) {
+    xmlBufferPtr buffer;
+    xmlSaveCtxtPtr save;
+    xmlNodePtr cur;
+    xmlChar *ret;
+
+    buffer = xmlBufferCreate();
+    save = xmlSaveToBuffer(buffer, "UTF-8", 0);
+    for (cur = list; cur != NULL; cur = cur->next)
+        xmlSaveTree(save, cur);
+    xmlSaveClose(save);
+
+    ret = xmlBufferDetach(buffer);
+    xmlBufferFree(buffer);
+    return ret;
+}
+
+static int
+testCtxtParseContent(void) {
+    xmlParserCtxtPtr ctxt;
+    xmlParserInputPtr input;
+    xmlDocPtr doc;
+    xmlNodePtr node, list;
+    const char *content;
+    xmlChar *output;
+    int i, j;
+    int err = 0;
+
+    static const char *const tests[] = {
+        "<!-- c -->\xF0\x9F\x98\x84<a/><b/>end",
+        "text<a:foo><b:foo/></a:foo>text<!-- c -->"
+    };
+
+    doc = xmlReadDoc(BAD_CAST "<doc xmlns:a='a'><elem xmlns:b='b'/></doc>",
+                     NULL, NULL, 0);
+    node = doc->children->children;
+
+    ctxt = xmlNewParserCtxt();
+
+    for (i = 0; (size_t) i < sizeof(tests) / sizeof(tests[0]); i++) {
+        content = tests[i];
+
+        for (j = 0; j < 2; j++) {
+            if (j == 0) {
+                input = xmlNewInputFromString(NULL, content,
+                                              XML_INPUT_BUF_STATIC);
+                list = xmlCtxtParseContent(ctxt, input, node, 0);
+            } else {
+                xmlParseInNodeContext(node, content, strlen(content), 0,
+                                      &list);
+            }
+
+            output = dumpNodeList(list);
+
+            if ((j == 0 && ctxt->nsWellFormed == 0) ||
+                strcmp((char *) output, content) != 0) {
+                fprintf(stderr, "%s failed test %d, got:\n%s\n",
+                        j == 0 ?
+                            "xmlCtxtParseContent" :
+                            "xmlParseInNodeContext",
+                        i, output);
+                err = 1;
+            }
+
+            xmlFree(output);
+            xmlFreeNodeList(list);
+        }
+    }
+
+    xmlFreeParserCtxt(ctxt);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static int
+testMmapInputDoc(xmlDocPtr doc, xmlDocPtr ref, const char *name) {
+    xmlChar *out, *refOut;
+    int size, refSize;
+    int err = 0;
+
+    if ((doc == NULL) || (ref == NULL)) {
+        fprintf(stderr, "testMmapInput: failed to parse %s\n", name);
+        xmlFreeDoc(doc);
+        xmlFreeDoc(ref);
+        return(1);
+    }
+
+    xmlDocDumpMemory(doc, &out, &size);
+    xmlDocDumpMemory(ref, &refOut, &refSize);
+    if ((size != refSize) || (memcmp(out, refOut, size) != 0)) {
+        fprintf(stderr, "testMmapInput: wrong result for %s\n", name);
+        err = 1;
+    }
+
+    xmlFree(out);
+    xmlFree(refOut);
+    xmlFreeDoc(doc);
+    xmlFreeDoc(ref);
+
+    return(err);
+}
+
+static int
+testMmapInput(void) {
+    static const char *const files[] = {
+        "test/att4",
+        "test/slashdot16.xml",
+        "test/ent2"
+    };
+    xmlDocPtr doc, ref;
+    FILE *tmp;
+    size_t i;
+    int err = 0;
+
+    for (i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        doc = xmlReadFile(files[i], NULL, XML_PARSE_MMAP | XML_PARSE_NOENT);
+        ref = xmlReadFile(files[i], NULL, XML_PARSE_NOENT);
+        err |= testMmapInputDoc(doc, ref, files[i]);
+    }
+
+    /*
+     * A file size which is a multiple of the page size requires an
+     * extra page for the terminating zero.
+     */
+    tmp = tmpfile();
+    if (tmp != NULL) {
+        char text[8192 - 12];
+
+        memset(text, 'x', sizeof(text));
+        fputs("<doc>", tmp);
+        fwrite(text, 1, sizeof(text), tmp);
+        fputs("</doc>\n", tmp);
+        fflush(tmp);
+
+        for (i = 0; i < 2; i++) {
+            rewind(tmp);
+            if (i == 0)
+                doc = xmlReadFd(fileno(tmp), "tmp.xml", NULL, XML_PARSE_MMAP);
+            else
+                ref = xmlReadFd(fileno(tmp), "tmp.xml", NULL, 0);
+        }
+        err |= testMmapInputDoc(doc, ref, "page-sized file");
+
+        fclose(tmp);
+    }
+
+    return(err);
+}
+
+static int
+testAsyncInput(void) {
+    xmlDocPtr doc, ref;
+    FILE *tmp;
+    int i;
+    int err = 0;
+
+    doc = xmlReadFile("test/slashdot16.xml", NULL, XML_PARSE_ASYNC_IO);
+    ref = xmlReadFile("test/slashdot16.xml", NULL, 0);
+    err |= testMmapInputDoc(doc, ref, "test/slashdot16.xml");
+
+    /* Larger than all read-ahead buffers together */
+    tmp = tmpfile();
+    if (tmp != NULL) {
+        fputs("<doc>\n", tmp);
+        for (i = 0; i < 100000; i++)
+            fprintf(tmp, "<e n='%d'>some text</e>\n", i);
+        fputs("</doc>\n", tmp);
+        fflush(tmp);
+
+        rewind(tmp);
+        doc = xmlReadFd(fileno(tmp), "tmp.xml", NULL, XML_PARSE_ASYNC_IO);
+        rewind(tmp);
+        ref = xmlReadFd(fileno(tmp), "tmp.xml", NULL, 0);
+        err |= testMmapInputDoc(doc, ref, "large file");
+
+        fclose(tmp);
+    }
+
+    return(err);
+}
+
+static int
+testArena(void) {
+    const char *xml =
+        "<!DOCTYPE doc [<!ENTITY e 'ent<i>x</i>'>]>\n"
+        "<doc a='1' b='x&amp;y' c='a longer attribute value'>\n"
+        "  <p>text &#x41; &lt;merged&gt; &e; more</p>\n"
+        "  <![CDATA[cdata <here>]]>\n"
+        "  <q xmlns='urn:q' c='2'>a<b/>b</q>\n"
+        "</doc>\n";
+    xmlDocPtr doc, ref, copy;
+    xmlNodePtr root, p, q, text;
+    xmlAttrPtr attr;
+    xmlChar *out, *refOut;
+    int size, refSize;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, XML_PARSE_ARENA);
+    ref = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    if ((doc == NULL) || (ref == NULL) || (doc->arena == NULL)) {
+        fprintf(stderr, "testArena: parsing failed\n");
+        xmlFreeDoc(doc);
+        xmlFreeDoc(ref);
+        return(1);
+    }
+
+    xmlDocDumpMemory(doc, &out, &size);
+    xmlDocDumpMemory(ref, &refOut, &refSize);
+    if ((size != refSize) || (memcmp(out, refOut, size) != 0)) {
+        fprintf(stderr, "testArena: wrong result\n");
+        err = 1;
+    }
+    xmlFree(out);
+    xmlFree(refOut);
+    xmlFreeDoc(ref);
+
+    /* Simple attribute values share a block with the attribute */
+    root = xmlDocGetRootElement(doc);
+    attr = xmlHasProp(root, BAD_CAST "c");
+    if ((attr == NULL) || (attr->children != (xmlNodePtr) (attr + 1)) ||
+        (attr->children->content != (xmlChar *) (attr->children + 1)) ||
+        (!xmlStrEqual(attr->children->content,
+                      BAD_CAST "a longer attribute value"))) {
+        fprintf(stderr, "testArena: attribute not allocated inline\n");
+        err = 1;
+    }
+    xmlSetProp(root, BAD_CAST "c", BAD_CAST "changed");
+    xmlRemoveProp(xmlHasProp(root, BAD_CAST "b"));
+
+    /* Modify and free arena nodes */
+    p = xmlFirstElementChild(root);
+    q = xmlLastElementChild(root);
+    text = p->children;
+    xmlNodeAddContent(text, BAD_CAST " appended");
+    xmlNodeSetContent(text, BAD_CAST "replaced");
+    xmlSetProp(root, BAD_CAST "a", BAD_CAST "new");
+    xmlUnlinkNode(q);
+    xmlFreeNode(q);
+
+    /* Copies into other documents don't use the arena */
+    ref = xmlNewDoc(BAD_CAST "1.0");
+    xmlDocSetRootElement(ref, xmlDocCopyNode(root, ref, 1));
+    xmlFreeDoc(doc);
+
+    copy = xmlCopyDoc(ref, 1);
+    xmlDocDumpMemory(ref, &out, &size);
+    if ((out == NULL) ||
+        (strstr((char *) out, "a=\"new\" c=\"changed\"") == NULL) ||
+        (strstr((char *) out, "<p>replaced&e; more</p>") == NULL) ||
+        (strstr((char *) out, "urn:q") != NULL)) {
+        fprintf(stderr, "testArena: wrong result after modification\n");
+        err = 1;
+    }
+    xmlFree(out);
+    xmlFreeDoc(copy);
+    xmlFreeDoc(ref);
+
+    return(err);
+}
+
+static int
+testArenaMove(void) {
+    const char *xml = "<doc><a x='1'>text</a><b/></doc>";
+    xmlDocPtr doc, other;
+    xmlNodePtr root, a, b, node;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, XML_PARSE_ARENA);
+    if ((doc == NULL) || (doc->arena == NULL)) {
+        fprintf(stderr, "testArenaMove: parsing failed\n");
+        xmlFreeDoc(doc);
+        return(1);
+    }
+    root = xmlDocGetRootElement(doc);
+    a = xmlFirstElementChild(root);
+    b = xmlLastElementChild(root);
+
+    other = xmlNewDoc(BAD_CAST "1.0");
+    xmlDocSetRootElement(other, xmlNewDocNode(other, NULL, BAD_CAST "o", NULL));
+
+    /* Arena nodes can't be moved to another document */
+    if ((xmlAddChild(xmlDocGetRootElement(other), a) != NULL) ||
+        (xmlDocSetRootElement(other, b) != NULL) ||
+        (xmlReplaceNode(xmlDocGetRootElement(other), a) != NULL) ||
+        (xmlSetTreeDoc(a, other) != -1) ||
+        (a->doc != doc) || (a->parent != root) ||
+        (b->doc != doc) || (b->parent != root) ||
+        (xmlDocGetRootElement(other)->children != NULL)) {
+        fprintf(stderr, "testArenaMove: arena node moved\n");
+        err = 1;
+    }
+
+    /* Also reject subtrees containing arena nodes */
+    node = xmlNewDocNode(other, NULL, BAD_CAST "c", NULL);
+    if ((xmlAddChild(root, node) != node) || (node->doc != doc) ||
+        (xmlAddChild(node, a) != a) ||
+        (xmlAddChild(xmlDocGetRootElement(other), node) != NULL) ||
+        (node->doc != doc) || (node->parent != root) ||
+        (a->doc != doc)) {
+        fprintf(stderr, "testArenaMove: arena subtree moved\n");
+        err = 1;
+    }
+
+    /* Moves within the document still work */
+    if ((xmlAddChild(b, a) != a) || (a->parent != b)) {
+        fprintf(stderr, "testArenaMove: move within document failed\n");
+        err = 1;
+    }
+
+    xmlFreeDoc(doc);
+    xmlFreeDoc(other);
+
+    return(err);
+}
+
+static int
+testCopyTree(void) {
+    const char *xml =
+        "<a:doc xmlns:a='urn:a' xmlns:b='urn:b' xmlns:c='urn:c'>"
+        "<a:item b:x='1' xml:lang='en'>"
+        "<b:f xmlns:b='urn:b2' b:y='2'>text<c:g/></b:f>"
+        "<c:h b:z='3'/>"
+        "</a:item>"
+        "</a:doc>";
+    const char *expected =
+        "<a:item xmlns:a=\"urn:a\" xmlns:b=\"urn:b\" xmlns:c=\"urn:c\" "
+        "b:x=\"1\" xml:lang=\"en\">"
+        "<b:f xmlns:b=\"urn:b2\" b:y=\"2\">text<c:g/></b:f>"
+        "<c:h b:z=\"3\"/>"
+        "</a:item>";
+    xmlDocPtr doc, other, copy;
+    xmlNodePtr item, node, text;
+    xmlBufferPtr buf;
+    int err = 0;
+    int i;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, XML_PARSE_ARENA);
+    if (doc == NULL) {
+        fprintf(stderr, "testCopyTree: parsing failed\n");
+        return(1);
+    }
+    item = xmlFirstElementChild(xmlDocGetRootElement(doc));
+    other = xmlNewDoc(BAD_CAST "1.0");
+
+    /*
+     * Namespaces declared outside of the subtree are added to the
+     * root of the copy, redeclared prefixes are resolved inside.
+     */
+    for (i = 0; i < 2; i++) {
+        xmlDocPtr target = i ? other : doc;
+
+        node = xmlDocCopyNode(item, target, 1);
+        buf = xmlBufferCreate();
+        xmlNodeDump(buf, target, node, 0, 0);
+        if (strcmp((char *) xmlBufferContent(buf), expected) != 0) {
+            fprintf(stderr, "testCopyTree: wrong copy %d: %s\n", i,
+                    (char *) xmlBufferContent(buf));
+            err = 1;
+        }
+        xmlBufferFree(buf);
+        xmlFreeNode(node);
+    }
+    xmlFreeDoc(other);
+
+    /* Document copies share the dictionary and use an arena */
+    copy = xmlCopyDoc(doc, 1);
+    if ((copy == NULL) || (copy->dict != doc->dict) ||
+        (copy->arena == NULL)) {
+        fprintf(stderr, "testCopyTree: document copy failed\n");
+        xmlFreeDoc(copy);
+        xmlFreeDoc(doc);
+        return(1);
+    }
+    node = xmlFirstElementChild(xmlDocGetRootElement(copy));
+    text = xmlFirstElementChild(node)->children;
+    if ((node->name != item->name) ||
+        (node->properties->name != item->properties->name)) {
+        fprintf(stderr, "testCopyTree: names not shared\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+
+    /* The copy must be independent */
+    xmlNodeSetContent(text, BAD_CAST "modified");
+    buf = xmlBufferCreate();
+    xmlNodeDump(buf, copy, node, 0, 0);
+    if (strstr((char *) xmlBufferContent(buf), ">modified<") == NULL) {
+        fprintf(stderr, "testCopyTree: wrong result after modification\n");
+        err = 1;
+    }
+    xmlBufferFree(buf);
+    xmlFreeDoc(copy);
+
+    return(err);
+}
+
+static int
+testDocSnapshot(void) {
+    const char *xml =
+        "<?xml version='1.0'?>\n"
+        "<!-- before -->\n"
+        "<!DOCTYPE doc [\n"
+        "<!ATTLIST item id ID #IMPLIED>\n"
+        "<!ENTITY e 'entity'>\n"
+        "]>\n"
+        "<doc xmlns='urn:d' xmlns:a='urn:a'>"
+        "<item id='i1' a:x='1' xml:lang='en'>text &e;<![CDATA[<c>]]></item>"
+        "<a:item id='i2'><?pi data?><!-- comment --></a:item>"
+        "</doc>\n";
+    xmlDocSnapshotPtr snap;
+    xmlDocPtr doc, copy1, copy2;
+    xmlAttrPtr attr;
+    xmlChar *ref, *out;
+    int refSize, size;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    snap = xmlNewDocSnapshot(doc);
+    if (snap == NULL) {
+        fprintf(stderr, "testDocSnapshot: creating snapshot failed\n");
+        xmlFreeDoc(doc);
+        return(1);
+    }
+    copy1 = xmlCopyDoc(doc, 1);
+    xmlDocDumpMemory(copy1, &ref, &refSize);
+    xmlFreeDoc(copy1);
+    xmlFreeDoc(doc);
+
+    copy1 = xmlDocSnapshotCopy(snap);
+    copy2 = xmlDocSnapshotCopy(snap);
+    xmlFreeDocSnapshot(snap);
+
+    xmlDocDumpMemory(copy1, &out, &size);
+    if ((size != refSize) || (memcmp(out, ref, size) != 0)) {
+        fprintf(stderr, "testDocSnapshot: wrong result:\n%s", out);
+        err = 1;
+    }
+    xmlFree(out);
+
+    attr = xmlGetID(copy1, BAD_CAST "i1");
+    if ((attr == NULL) || (attr->doc != copy1)) {
+        fprintf(stderr, "testDocSnapshot: ID not found\n");
+        err = 1;
+    }
+
+    /* Copies are independent */
+    xmlNodeSetContent(xmlDocGetRootElement(copy1), BAD_CAST "modified");
+    xmlFreeDoc(copy1);
+    xmlDocDumpMemory(copy2, &out, &size);
+    if ((size != refSize) || (memcmp(out, ref, size) != 0)) {
+        fprintf(stderr, "testDocSnapshot: copy was modified:\n%s", out);
+        err = 1;
+    }
+    xmlFree(out);
+    xmlFreeDoc(copy2);
+    xmlFree(ref);
+
+    return(err);
+}
+
+static int
+testDocBinary(void) {
+    const char *xml =
+        "<?xml version='1.0' encoding='ISO-8859-1' standalone='yes'?>\n"
+        "<!-- before -->\n"
+        "<!DOCTYPE doc [\n"
+        "<!ELEMENT doc (item|a:item)*>\n"
+        "<!ATTLIST item id ID #IMPLIED type (x|y) 'x'>\n"
+        "<!ENTITY e 'ent<b>ity</b>'>\n"
+        "<!ENTITY t 'plain'>\n"
+        "<!NOTATION n SYSTEM 'urn:n'>\n"
+        "<!-- in DTD -->\n"
+        "]>\n"
+        "<doc xmlns='urn:d' xmlns:a='urn:a'>\n"
+        "  <item id='i1' a:x='1&#10;&t;' xml:lang='en'>"
+        "text &e;<![CDATA[<c>]]></item>\n"
+        "  <a:item xmlns:a='urn:other' a:y='2'><?pi data?>"
+        "<!-- comment --></a:item>\n"
+        "</doc>\n";
+    xmlDocPtr doc, copy;
+    xmlAttrPtr attr;
+    xmlChar *ref, *mem, *out;
+    int refSize, size, outSize, i;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    xmlDocDumpMemory(doc, &ref, &refSize);
+    if (xmlDocSaveBinaryMemory(doc, &mem, &size) < 0) {
+        fprintf(stderr, "testDocBinary: saving failed\n");
+        xmlFree(ref);
+        xmlFreeDoc(doc);
+        return(1);
+    }
+    xmlFreeDoc(doc);
+
+    copy = xmlDocLoadBinaryMemory((const char *) mem, size);
+    if (copy == NULL) {
+        fprintf(stderr, "testDocBinary: loading failed\n");
+        err = 1;
+    } else {
+        xmlNodePtr ent;
+
+        xmlDocDumpMemory(copy, &out, &outSize);
+        if ((outSize != refSize) || (memcmp(out, ref, outSize) != 0)) {
+            fprintf(stderr, "testDocBinary: wrong result:\n%s", out);
+            err = 1;
+        }
+        xmlFree(out);
+
+        attr = xmlGetID(copy, BAD_CAST "i1");
+        if ((attr == NULL) || (attr->doc != copy)) {
+            fprintf(stderr, "testDocBinary: ID not found\n");
+            err = 1;
+        }
+
+        /* The parsed content of entities is kept */
+        ent = attr != NULL ? attr->parent->children->next : NULL;
+        out = xmlNodeGetContent(ent);
+        if ((ent == NULL) || (ent->type != XML_ENTITY_REF_NODE) ||
+            (!xmlStrEqual(out, BAD_CAST "entity"))) {
+            fprintf(stderr, "testDocBinary: wrong entity content\n");
+            err = 1;
+        }
+        xmlFree(out);
+
+        xmlFreeDoc(copy);
+    }
+
+    for (i = 0; i < size; i++) {
+        copy = xmlDocLoadBinaryMemory((const char *) mem, i);
+        if (copy != NULL) {
+            fprintf(stderr, "testDocBinary: truncated input at %d "
+                    "accepted\n", i);
+            xmlFreeDoc(copy);
+            err = 1;
+            break;
+        }
+    }
+
+    xmlFree(mem);
+    xmlFree(ref);
+    return(err);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static int
+testDocImageCheck(xmlDocPtr doc, const xmlChar *ref, const char *what) {
+    xmlBufferPtr buf;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr res;
+    int err = 0;
+
+    buf = xmlBufferCreate();
+    xmlNodeDump(buf, doc, xmlDocGetRootElement(doc), 0, 0);
+    if (!xmlStrEqual(xmlBufferContent(buf), ref)) {
+        fprintf(stderr, "testDocImage: %s: wrong result:\n%s\n",
+                what, (const char *) xmlBufferContent(buf));
+        err = 1;
+    }
+    xmlBufferFree(buf);
+
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "d", BAD_CAST "urn:d");
+    xmlXPathRegisterNs(ctxt, BAD_CAST "a", BAD_CAST "urn:a");
+    res = xmlXPathEval(BAD_CAST "string(/d:doc/d:item/@a:x)", ctxt);
+    if ((res == NULL) || (res->type != XPATH_STRING) ||
+        (!xmlStrEqual(res->stringval, BAD_CAST "1"))) {
+        fprintf(stderr, "testDocImage: %s: wrong XPath result\n", what);
+        err = 1;
+    }
+    xmlXPathFreeObject(res);
+    res = xmlXPathEval(BAD_CAST "count(//a:item/comment() | //processing-instruction())", ctxt);
+    if ((res == NULL) || (res->type != XPATH_NUMBER) ||
+        (res->floatval != 2)) {
+        fprintf(stderr, "testDocImage: %s: wrong XPath count\n", what);
+        err = 1;
+    }
+    xmlXPathFreeObject(res);
+    xmlXPathFreeContext(ctxt);
+
+    return(err);
+}
+
+static int
+testDocImage(void) {
+    const char *xml =
+        "<?xml version='1.0'?>\n"
+        "<!-- before -->\n"
+        "<!DOCTYPE doc [\n"
+        "<!ENTITY e 'entity'>\n"
+        "]>\n"
+        "<doc xmlns='urn:d' xmlns:a='urn:a'>"
+        "<item id='i1' a:x='1' xml:lang='en'>text &e;<![CDATA[<c>]]></item>"
+        "<a:item id='i2'><?pi data?><!-- comment --></a:item>"
+        "</doc>\n";
+    const char *filename = "testparser-image.tmp";
+    xmlDocPtr doc, image1, image2;
+    xmlBufferPtr buf;
+    xmlChar *ref;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    buf = xmlBufferCreate();
+    xmlNodeDump(buf, doc, xmlDocGetRootElement(doc), 0, 0);
+    ref = xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+    if (xmlDocSaveImage(doc, filename) < 0) {
+        fprintf(stderr, "testDocImage: saving failed\n");
+        xmlFree(ref);
+        xmlFreeDoc(doc);
+        return(1);
+    }
+    xmlFreeDoc(doc);
+
+    /* The second mapping can't use the same address */
+    image1 = xmlDocMapImage(filename);
+    image2 = xmlDocMapImage(filename);
+    remove(filename);
+    if ((image1 == NULL) || (image2 == NULL) || (image1 == image2)) {
+        fprintf(stderr, "testDocImage: mapping failed\n");
+        err = 1;
+    } else {
+        if ((image1->properties & XML_DOC_FROZEN) == 0) {
+            fprintf(stderr, "testDocImage: image isn't frozen\n");
+            err = 1;
+        }
+        err |= testDocImageCheck(image1, ref, "first image");
+        err |= testDocImageCheck(image2, ref, "second image");
+    }
+    xmlFreeDoc(image1);
+    xmlFreeDoc(image2);
+
+    if (xmlDocMapImage("testparser-missing.tmp") != NULL) {
+        fprintf(stderr, "testDocImage: missing file mapped\n");
+        err = 1;
+    }
+
+    xmlFree(ref);
+    return(err);
+}
+
+static int
+testTreeBuilderDoc(int options) {
+    const char *expected =
+        "<?xml version=\"1.0\"?>\n"
+        "<doc xmlns=\"urn:d\" xmlns:a=\"urn:a\">"
+        "<item a:x=\"1&lt;\">tu</item><item a:x=\"1&lt;\">tu</item>"
+        "<e xmlns=\"\" y=\"2\"><a:f/></e>"
+        "</doc>\n";
+    xmlDocPtr doc;
+    xmlTreeBuilderPtr builder;
+    const xmlChar *item;
+    xmlChar *out = NULL;
+    int d, a, none, i, size;
+    int err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    builder = xmlNewTreeBuilder(doc, NULL, options);
+    item = xmlDictLookup(xmlTreeBuilderGetDict(builder), BAD_CAST "item",
+                         -1);
+
+    d = xmlTreeBuilderDeclareNs(builder, BAD_CAST "urn:d", NULL);
+    a = xmlTreeBuilderDeclareNs(builder, BAD_CAST "urn:a", BAD_CAST "a");
+    if ((xmlTreeBuilderDeclareNs(builder, BAD_CAST "urn:x",
+                                 BAD_CAST "a") != -1) ||
+        (xmlTreeBuilderStartElement(builder, 5, BAD_CAST "doc") != -1)) {
+        fprintf(stderr, "testTreeBuilder: invalid namespace accepted\n");
+        err = 1;
+    }
+    xmlTreeBuilderStartElement(builder, d, BAD_CAST "doc");
+    for (i = 0; i < 2; i++) {
+        xmlTreeBuilderStartElement(builder, d, item);
+        xmlTreeBuilderAttribute(builder, a, BAD_CAST "x",
+                                BAD_CAST "1<2", 2);
+        xmlTreeBuilderText(builder, BAD_CAST "t", -1);
+        xmlTreeBuilderText(builder, BAD_CAST "u", -1);
+        xmlTreeBuilderEndElement(builder);
+    }
+    none = xmlTreeBuilderDeclareNs(builder, BAD_CAST "", NULL);
+    xmlTreeBuilderStartElement(builder, none, BAD_CAST "e");
+    if (xmlTreeBuilderAttribute(builder, none, BAD_CAST "y",
+                                BAD_CAST "2", -1) != -1) {
+        fprintf(stderr, "testTreeBuilder: default namespace on "
+                "attribute\n");
+        err = 1;
+    }
+    xmlTreeBuilderAttribute(builder, -1, BAD_CAST "y", BAD_CAST "2", -1);
+    xmlTreeBuilderStartElement(builder, a, BAD_CAST "f");
+
+    /* Closes the open elements */
+    if (xmlTreeBuilderFinish(builder) != 0) {
+        fprintf(stderr, "testTreeBuilder: finish failed\n");
+        err = 1;
+    }
+    if (xmlTreeBuilderEndElement(builder) != -1) {
+        fprintf(stderr, "testTreeBuilder: element still open\n");
+        err = 1;
+    }
+    xmlFreeTreeBuilder(builder);
+
+    xmlDocDumpMemory(doc, &out, &size);
+    if ((out == NULL) || (strcmp((char *) out, expected) != 0)) {
+        fprintf(stderr, "testTreeBuilder: got\n%s", (char *) out);
+        err = 1;
+    }
+    if (xmlDocGetRootElement(doc)->children->children->next == NULL) {
+        fprintf(stderr, "testTreeBuilder: text was merged\n");
+        err = 1;
+    }
+    if (((options & XML_TREE_BUILDER_ARENA) != 0) != (doc->arena != NULL)) {
+        fprintf(stderr, "testTreeBuilder: wrong arena\n");
+        err = 1;
+    }
+
+    xmlFree(out);
+    xmlFreeDoc(doc);
+    return(err);
+}
+
+static int
+testTreeBuilder(void) {
+    const char *xml =
+        "<!DOCTYPE doc [\n"
+        "<!ATTLIST e id ID #IMPLIED>\n"
+        "]>\n"
+        "<doc a='1'><e/></doc>";
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    xmlTreeBuilderPtr builder;
+    xmlAttrPtr attr;
+    int err = 0;
+
+    err |= testTreeBuilderDoc(0);
+    err |= testTreeBuilderDoc(XML_TREE_BUILDER_ARENA);
+
+    /* Append to an existing element, IDs are added by the fixup */
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    root = xmlDocGetRootElement(doc);
+    builder = xmlNewTreeBuilder(doc, root, 0);
+    xmlTreeBuilderAttribute(builder, -1, BAD_CAST "b", BAD_CAST "2", -1);
+    xmlTreeBuilderStartElement(builder, -1, BAD_CAST "e");
+    xmlTreeBuilderAttribute(builder, -1, BAD_CAST "id", BAD_CAST "i1", -1);
+    if (xmlTreeBuilderFinish(builder) != 0) {
+        fprintf(stderr, "testTreeBuilder: finish failed\n");
+        err = 1;
+    }
+    xmlFreeTreeBuilder(builder);
+
+    attr = xmlGetID(doc, BAD_CAST "i1");
+    if ((attr == NULL) || (attr->parent != root->last) ||
+        (root->properties->next == NULL) ||
+        (!xmlStrEqual(root->properties->next->name, BAD_CAST "b"))) {
+        fprintf(stderr, "testTreeBuilder: appending failed\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+static int
+testFreeDocAsync(void) {
+    const char *xml =
+        "<!DOCTYPE doc [\n"
+        "<!ATTLIST e id ID #IMPLIED>\n"
+        "<!ENTITY ent 'x<e id=\"i2\"/>'>\n"
+        "]>\n"
+        "<doc xmlns:a='urn:a'>"
+        "<e id='i1' a:b='1'>t&ent;<![CDATA[c]]></e><!--c--><?pi?>"
+        "<n%d/><n%d/><n%d/></doc>";
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    char buf[500];
+    int i, ret, calls, err = 0;
+
+    /* The parser keeps adding strings to the shared dictionary */
+    ctxt = xmlNewParserCtxt();
+    for (i = 0; i < 200; i++) {
+        snprintf(buf, sizeof(buf), xml, i, i + 1000, i + 2000);
+        doc = xmlCtxtReadDoc(ctxt, BAD_CAST buf, NULL, NULL,
+                             i % 2 ? XML_PARSE_NOENT : 0);
+        if (doc == NULL) {
+            fprintf(stderr, "testFreeDocAsync: parsing failed\n");
+            err = 1;
+            break;
+        }
+        xmlFreeDocAsync(doc);
+    }
+    xmlFreeDocAsyncWait();
+
+    for (i = 0; i < 2; i++) {
+        snprintf(buf, sizeof(buf), xml, 1, 2, 3);
+        doc = xmlCtxtReadDoc(ctxt, BAD_CAST buf, NULL, NULL,
+                             i ? XML_PARSE_NOENT : 0);
+        root = xmlDocGetRootElement(doc);
+        for (ret = 0; ret < 100; ret++)
+            xmlNewTextChild(xmlNewChild(root, NULL, BAD_CAST "x", NULL),
+                            NULL, BAD_CAST "y", BAD_CAST "text");
+
+        calls = 0;
+        do {
+            ret = xmlFreeDocIncremental(doc, 7);
+            calls++;
+        } while (ret == 1);
+        if ((ret != 0) || (calls < 40)) {
+            fprintf(stderr, "testFreeDocAsync: incremental free failed\n");
+            err = 1;
+        }
+    }
+
+    xmlFreeParserCtxt(ctxt);
+    return(err);
+}
+
+static int
+countFragments(void *ctxt, const xmlChar *content ATTRIBUTE_UNUSED,
+               int len ATTRIBUTE_UNUSED) {
+    int *count = ctxt;
+
+    *count += 1;
+    return(*count >= 2 ? 42 : 0);
+}
+
+static int
+testNodeContent(void) {
+    const char *xml =
+        "<!DOCTYPE doc [\n"
+        "<!ENTITY e 'ent<b>ity</b>'>\n"
+        "]>\n"
+        "<doc><single>text</single>"
+        "<mixed>a<b>b</b>&e;<![CDATA[c]]><!-- x --></mixed>"
+        "<empty/></doc>";
+    xmlDocPtr doc;
+    xmlNodePtr single, mixed, empty;
+    const xmlChar *str;
+    xmlChar *mem, *content;
+    int count = 0;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    single = doc->children->next->children;
+    mixed = single->next;
+    empty = mixed->next;
+
+    str = xmlNodeBorrowContent(single, &mem);
+    if ((str != single->children->content) || (mem != NULL)) {
+        fprintf(stderr, "testNodeContent: single text not borrowed\n");
+        err = 1;
+    }
+    str = xmlNodeBorrowContent(empty, &mem);
+    if ((str == NULL) || (*str != 0) || (mem != NULL)) {
+        fprintf(stderr, "testNodeContent: empty element not borrowed\n");
+        err = 1;
+    }
+    if (xmlNodeBorrowContent(mixed, NULL) != NULL) {
+        fprintf(stderr, "testNodeContent: mixed content borrowed\n");
+        err = 1;
+    }
+
+    str = xmlNodeBorrowContent(mixed, &mem);
+    if ((mem == NULL) || (str != mem) ||
+        (!xmlStrEqual(str, BAD_CAST "abentityc"))) {
+        fprintf(stderr, "testNodeContent: wrong mixed content\n");
+        err = 1;
+    }
+    xmlFree(mem);
+
+    content = xmlNodeGetContent(doc->children->next);
+    if (!xmlStrEqual(content, BAD_CAST "textabentityc")) {
+        fprintf(stderr, "testNodeContent: wrong content: %s\n", content);
+        err = 1;
+    }
+    xmlFree(content);
+
+    content = xmlNodeListGetString(doc, mixed->children, 1);
+    if (!xmlStrEqual(content, BAD_CAST "aentityc")) {
+        fprintf(stderr, "testNodeContent: wrong list string: %s\n",
+                content);
+        err = 1;
+    }
+    xmlFree(content);
+
+    if ((xmlNodeWalkContent(mixed, countFragments, &count) != 42) ||
+        (count != 2)) {
+        fprintf(stderr, "testNodeContent: walk not stopped\n");
+        err = 1;
+    }
+
+    xmlFreeDoc(doc);
+    return(err);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+static int
+testNoBlanks(void) {
+    const xmlChar xml[] =
+        "<refentry>\n"
+        "  <refsect1>\n"
+        "    <para>\n"
+        "      Run <command>tester --help</command> for more options.\n"
+        "    </para>\n"
+        "  </refsect1>\n"
+        "</refentry>\n";
+    const xmlChar expect[] =
+        "<?xml version=\"1.0\"?>\n"
+        "<refentry><refsect1><para>\n"
+        "      Run <command>tester --help</command> for more options.\n"
+        "    </para></refsect1></refentry>\n";
+    xmlDocPtr doc;
+    xmlChar *out;
+    int size;
+    int err = 0;
+
+    doc = xmlReadDoc(xml, NULL, NULL, XML_PARSE_NOBLANKS);
+    xmlDocDumpMemory(doc, &out, &size);
+    xmlFreeDoc(doc);
+
+    if (!xmlStrEqual(out, expect)) {
+        fprintf(stderr, "parsing with XML_PARSE_NOBLANKS failed\n");
+        err = 1;
+    }
+    xmlFree(out);
+
+    return err;
+}
+
+static int
+testSaveNullEncDoc(const char *xml, const char *expect) {
+    xmlDocPtr doc;
+    xmlBufferPtr buffer;
+    xmlSaveCtxtPtr save;
+    const xmlChar *result;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+
+    buffer = xmlBufferCreate();
+    save = xmlSaveToBuffer(buffer, NULL, 0);
+    xmlSaveDoc(save, doc);
+    xmlSaveClose(save);
+
+    result = xmlBufferContent(buffer);
+    if (strcmp((char *) result, expect) != 0) {
+        fprintf(stderr, "xmlSave with NULL encodíng failed\n");
+        err = 1;
+    }
+
+    xmlBufferFree(buffer);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+static int
+testSaveNullEnc(void) {
+    int err = 0;
+
+    err |= testSaveNullEncDoc(
+        "<?xml version=\"1.0\"?><doc>\xC3\x98</doc>",
+        "<?xml version=\"1.0\"?>\n<doc>&#xD8;</doc>\n");
+    err |= testSaveNullEncDoc(
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?><doc>\xC3\x98</doc>",
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<doc>\xC3\x98</doc>\n");
+    err |= testSaveNullEncDoc(
+        "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?><doc>\xD8</doc>",
+        "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n<doc>\xD8</doc>\n");
+
+    return err;
+}
+
+static int
+testDocDumpFormatMemoryEnc(void) {
+    const char *xml = "<doc>\xC3\x98</doc>";
+    const char *expect =
+        "<?xml version=\"1.0\" encoding=\"iso-8859-1\"?>\n"
+        "<doc>\xD8</doc>\n";
+    xmlDocPtr doc;
+    xmlChar *text;
+    int len;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    xmlDocDumpFormatMemoryEnc(doc, &text, &len, "iso-8859-1", 0);
+
+    if (strcmp((char *) text, expect) != 0) {
+        fprintf(stderr, "xmlDocDumpFormatMemoryEnc failed\n");
+        err = 1;
+    }
+
+    xmlFree(text);
+    xmlFreeDoc(doc);
+    return err;
+}
+
+/*
+ * Text for single-byte encodings is escaped and encoded in one pass.
+ * Unrepresentable characters become decimal character references.
+ */
+static int
+testSaveSingleByteEnc(void) {
+    static const char xml[] =
+        "<doc a='\xC3\xA9\xE2\x82\xAC\xE4\xB8\xAD&#9;\"'>"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "\xC3\xA9 \xE2\x82\xAC \xE4\xB8\xAD \xF0\x9F\x98\x80 &amp; &lt;"
+        "<e/>\xC3\xA9</doc>";
+    static const char *const encodings[] = {
+        "ISO-8859-1", "windows-1252", "US-ASCII"
+    };
+    static const char *const expected[] = {
+        "<?xml version=\"1.0\" encoding=\"ISO-8859-1\"?>\n"
+        "<doc a=\"\xE9&#8364;&#20013;&#9;&quot;\">"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "\xE9 &#8364; &#20013; &#128512; &amp; &lt;<e/>\xE9</doc>\n",
+        "<?xml version=\"1.0\" encoding=\"windows-1252\"?>\n"
+        "<doc a=\"\xE9\x80&#20013;&#9;&quot;\">"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "\xE9 \x80 &#20013; &#128512; &amp; &lt;<e/>\xE9</doc>\n",
+        "<?xml version=\"1.0\" encoding=\"US-ASCII\"?>\n"
+        "<doc a=\"&#233;&#8364;&#20013;&#9;&quot;\">"
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+        "&#233; &#8364; &#20013; &#128512; &amp; &lt;<e/>&#233;</doc>\n"
+    };
+    xmlDocPtr doc;
+    size_t i;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+
+    for (i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++) {
+        xmlBufferPtr buffer;
+        xmlSaveCtxtPtr save;
+
+        buffer = xmlBufferCreate();
+        save = xmlSaveToBuffer(buffer, encodings[i], 0);
+        xmlSaveDoc(save, doc);
+        xmlSaveClose(save);
+
+        if (strcmp((char *) xmlBufferContent(buffer), expected[i]) != 0) {
+            fprintf(stderr, "xmlSave with encoding %s failed\n",
+                    encodings[i]);
+            err = 1;
+        }
+
+        xmlBufferFree(buffer);
+    }
+
+    xmlFreeDoc(doc);
+    return err;
+}
+
+static int
+testChunkedOutput(void) {
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    xmlOutputBufferPtr ref, out;
+    const xmlChar *expect, *chunk;
+    xmlChar *flat;
+    FILE *tmp;
+    void *iter = NULL;
+    size_t expectLen, len, pos = 0;
+    int nbChunks = 0;
+    int i;
+    int err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 20000; i++)
+        xmlNewTextChild(root, NULL, BAD_CAST "elem", BAD_CAST "some text");
+
+    ref = xmlAllocOutputBuffer(NULL);
+    xmlNodeDumpOutput(ref, doc, root, 0, 0, NULL);
+    expect = xmlOutputBufferGetContent(ref);
+    expectLen = xmlOutputBufferGetSize(ref);
+
+    out = xmlOutputBufferCreateChunked(NULL);
+    xmlNodeDumpOutput(out, doc, root, 0, 0, NULL);
+
+    while ((chunk = xmlOutputBufferNextChunk(out, &iter, &len)) != NULL) {
+        if ((pos + len > expectLen) || (memcmp(expect + pos, chunk, len))) {
+            fprintf(stderr, "chunked output: chunk %d differs\n", nbChunks);
+            err = 1;
+            break;
+        }
+        pos += len;
+        nbChunks++;
+    }
+    if ((pos != expectLen) || (nbChunks < 2)) {
+        fprintf(stderr, "chunked output: got %d chunks, %lu bytes\n",
+                nbChunks, (unsigned long) pos);
+        err = 1;
+    }
+
+    flat = xmlOutputBufferFlatten(out, &len);
+    if ((flat == NULL) || (len != expectLen) ||
+        (strcmp((char *) flat, (char *) expect) != 0)) {
+        fprintf(stderr, "chunked output: flatten failed\n");
+        err = 1;
+    }
+    xmlFree(flat);
+
+    tmp = tmpfile();
+    if (tmp != NULL) {
+        char *data = xmlMalloc(expectLen + 1);
+
+        xmlNodeDumpOutput(out, doc, root, 0, 0, NULL);
+        if (xmlOutputBufferWriteChunksFd(out, fileno(tmp)) !=
+            (long) expectLen) {
+            fprintf(stderr, "chunked output: writing to fd failed\n");
+            err = 1;
+        }
+        rewind(tmp);
+        if ((fread(data, 1, expectLen + 1, tmp) != expectLen) ||
+            (memcmp(data, expect, expectLen) != 0)) {
+            fprintf(stderr, "chunked output: wrong data written to fd\n");
+            err = 1;
+        }
+        xmlFree(data);
+        fclose(tmp);
+    }
+
+    iter = NULL;
+    if (xmlOutputBufferNextChunk(out, &iter, &len) != NULL) {
+        fprintf(stderr, "chunked output: not empty after write\n");
+        err = 1;
+    }
+    if (xmlOutputBufferNextChunk(ref, &iter, &len) != NULL) {
+        fprintf(stderr, "chunked output: iterated memory buffer\n");
+        err = 1;
+    }
+
+    xmlOutputBufferClose(out);
+    xmlOutputBufferClose(ref);
+    xmlFreeDoc(doc);
+    return err;
+}
+
+typedef struct {
+    xmlBufferPtr buf;
+    int limit;
+} testAsyncSink;
+
+static int
+testAsyncSinkWrite(void *ctxt, const char *data, int len) {
+    testAsyncSink *sink = ctxt;
+
+    if ((sink->limit > 0) &&
+        ((int) xmlBufferLength(sink->buf) + len > sink->limit))
+        return(-1);
+    if (xmlBufferAdd(sink->buf, BAD_CAST data, len) < 0)
+        return(-1);
+    return(len);
+}
+
+static int
+testAsyncOutput(void) {
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    xmlOutputBufferPtr ref, out;
+    testAsyncSink sink;
+    const xmlChar *expect;
+    size_t expectLen;
+    int i, ret;
+    int err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 20000; i++)
+        xmlNewTextChild(root, NULL, BAD_CAST "elem", BAD_CAST "some text");
+
+    ref = xmlAllocOutputBuffer(NULL);
+    xmlNodeDumpOutput(ref, doc, root, 0, 0, NULL);
+    expect = xmlOutputBufferGetContent(ref);
+    expectLen = xmlOutputBufferGetSize(ref);
+
+    for (i = 0; i < 2; i++) {
+        sink.buf = xmlBufferCreate();
+        sink.limit = (i == 0) ? 0 : 5000;
+
+        out = xmlOutputBufferCreateIO(testAsyncSinkWrite, NULL, &sink, NULL);
+        if (xmlOutputBufferSetAsync(out, 1000, 2) < 0) {
+            /* Not supported in this build */
+            xmlOutputBufferClose(out);
+            xmlBufferFree(sink.buf);
+            break;
+        }
+        xmlNodeDumpOutput(out, doc, root, 0, 0, NULL);
+        ret = xmlOutputBufferClose(out);
+
+        if (i == 0) {
+            if ((ret != (int) expectLen) ||
+                ((size_t) xmlBufferLength(sink.buf) != expectLen) ||
+                (memcmp(xmlBufferContent(sink.buf), expect,
+                        expectLen) != 0)) {
+                fprintf(stderr, "async output: wrong result\n");
+                err = 1;
+            }
+        } else {
+            if (ret >= 0) {
+                fprintf(stderr, "async output: write error not reported\n");
+                err = 1;
+            }
+        }
+
+        xmlBufferFree(sink.buf);
+    }
+
+    xmlOutputBufferClose(ref);
+    xmlFreeDoc(doc);
+    return err;
+}
+
+static xmlBufferPtr
+testParallelSaveRun(xmlDocPtr doc, xmlNodePtr node, const char *encoding,
+                    int options, int nbThreads) {
+    xmlBufferPtr buffer;
+    xmlSaveCtxtPtr save;
+
+    buffer = xmlBufferCreate();
+    save = xmlSaveToBuffer(buffer, encoding, options);
+    xmlSaveSetParallel(save, nbThreads, 10);
+    if (node != NULL)
+        xmlSaveTree(save, node);
+    else
+        xmlSaveDoc(save, doc);
+    xmlSaveClose(save);
+
+    return(buffer);
+}
+
+static int
+testParallelSave(void) {
+    static const int options[] = {
+        0, XML_SAVE_FORMAT, XML_SAVE_FORMAT | XML_SAVE_NO_EMPTY,
+        XML_SAVE_WSNONSIG
+    };
+    static const char *const encodings[] = { NULL, "UTF-8", "ISO-8859-1" };
+    xmlBufferPtr text;
+    xmlDocPtr doc;
+    xmlNodePtr node;
+    size_t i, j, k;
+    int err = 0;
+
+    text = xmlBufferCreate();
+    xmlBufferCCat(text, "<doc xmlns='urn:d' xmlns:p='urn:p'><list>");
+    for (i = 0; i < 500; i++) {
+        xmlBufferCCat(text,
+            "<p:item a='1'><name>n\xC3\xA9</name><e/><!--c--><?pi x?>"
+            "<mixed>a<b>b</b>&amp;<![CDATA[<c>]]></mixed></p:item>");
+        if (i % 100 == 0)
+            xmlBufferCCat(text, "text");
+    }
+    xmlBufferCCat(text, "</list><tail><x/><y/></tail></doc>");
+    doc = xmlReadDoc(xmlBufferContent(text), NULL, NULL, XML_PARSE_NOBLANKS);
+    xmlBufferFree(text);
+
+    if (xmlSaveSetParallel(NULL, 4, 0) != -1) {
+        fprintf(stderr, "xmlSaveSetParallel accepted NULL context\n");
+        err = 1;
+    }
+
+    for (i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        for (j = 0; j < sizeof(encodings) / sizeof(encodings[0]); j++) {
+            for (k = 0; k < 3; k++) {
+                xmlBufferPtr ref, out;
+
+                node = (k == 0) ? NULL :
+                       (k == 1) ? xmlDocGetRootElement(doc) :
+                       xmlDocGetRootElement(doc)->children;
+                ref = testParallelSaveRun(doc, node, encodings[j],
+                                          options[i], 0);
+                out = testParallelSaveRun(doc, node, encodings[j],
+                                          options[i], 4);
+                if ((xmlBufferLength(ref) != xmlBufferLength(out)) ||
+                    (memcmp(xmlBufferContent(ref), xmlBufferContent(out),
+                            xmlBufferLength(ref)) != 0)) {
+                    fprintf(stderr, "parallel save differs: options %d, "
+                            "encoding %s, node %d\n", options[i],
+                            encodings[j] ? encodings[j] : "none", (int) k);
+                    err = 1;
+                }
+                xmlBufferFree(ref);
+                xmlBufferFree(out);
+            }
+        }
+    }
+
+    xmlFreeDoc(doc);
+    return err;
+}
+
+static xmlReallocFunc testSaveMeasureOrigRealloc;
+static int testSaveMeasureReallocs;
+
+static void *
+testSaveMeasureRealloc(void *ptr, size_t size) {
+    testSaveMeasureReallocs++;
+    return(testSaveMeasureOrigRealloc(ptr, size));
+}
+
+static xmlBufferPtr
+testSaveMeasureRun(xmlDocPtr doc, xmlNodePtr node, const char *encoding,
+                   int options, int *reallocs) {
+    xmlFreeFunc freeFunc;
+    xmlMallocFunc mallocFunc;
+    xmlReallocFunc reallocFunc;
+    xmlStrdupFunc strdupFunc;
+    xmlBufferPtr buffer;
+    xmlSaveCtxtPtr save;
+
+    buffer = xmlBufferCreate();
+    save = xmlSaveToBuffer(buffer, encoding, options);
+
+    xmlMemGet(&freeFunc, &mallocFunc, &reallocFunc, &strdupFunc);
+    testSaveMeasureOrigRealloc = reallocFunc;
+    xmlMemSetup(freeFunc, mallocFunc, testSaveMeasureRealloc, strdupFunc);
+    testSaveMeasureReallocs = 0;
+    if (node != NULL)
+        xmlSaveTree(save, node);
+    else
+        xmlSaveDoc(save, doc);
+    xmlSaveClose(save);
+    *reallocs = testSaveMeasureReallocs;
+    xmlMemSetup(freeFunc, mallocFunc, reallocFunc, strdupFunc);
+
+    return(buffer);
+}
+
+static int
+testSaveMeasure(void) {
+    static const int options[] = {
+        0, XML_SAVE_FORMAT, XML_SAVE_NO_DECL | XML_SAVE_NO_EMPTY
+    };
+    static const char *const encodings[] = { NULL, "UTF-16", "ISO-8859-1" };
+    xmlBufferPtr ref, out;
+    xmlDocPtr doc;
+    xmlNodePtr root, node;
+    size_t i, j, k;
+    int reallocs, refReallocs;
+    int err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 5000; i++) {
+        node = xmlNewChild(root, NULL, BAD_CAST "item",
+                           BAD_CAST "a < b & \xC3\xA9");
+        xmlNewProp(node, BAD_CAST "att", BAD_CAST "\"quoted\"\n");
+    }
+
+    for (i = 0; i < sizeof(options) / sizeof(options[0]); i++) {
+        for (j = 0; j < sizeof(encodings) / sizeof(encodings[0]); j++) {
+            for (k = 0; k < 2; k++) {
+                node = k ? root->children : NULL;
+                ref = testSaveMeasureRun(doc, node, encodings[j],
+                                         options[i], &refReallocs);
+                out = testSaveMeasureRun(doc, node, encodings[j],
+                                         options[i] | XML_SAVE_MEASURE,
+                                         &reallocs);
+
+                if ((xmlBufferLength(out) != xmlBufferLength(ref)) ||
+                    (memcmp(xmlBufferContent(out), xmlBufferContent(ref),
+                            xmlBufferLength(ref)) != 0)) {
+                    fprintf(stderr, "testSaveMeasure: output differs "
+                            "(options %d, encoding %s, node %d)\n",
+                            options[i], encodings[j], (int) k);
+                    err = 1;
+                }
+                if ((k == 0) && (reallocs >= refReallocs)) {
+                    fprintf(stderr, "testSaveMeasure: %d reallocs, "
+                            "expected less than %d\n",
+                            reallocs, refReallocs);
+                    err = 1;
+                }
+
+                xmlBufferFree(ref);
+                xmlBufferFree(out);
+            }
+        }
+    }
+
+    xmlFreeDoc(doc);
+    return(err);
+}
+
+static int testSaveResetCloses;
+
+static int
+testSaveResetClose(void *ctxt ATTRIBUTE_UNUSED) {
+    testSaveResetCloses++;
+    return(0);
+}
+
+static int
+testSaveResetWrite(void *ctxt, const char *buffer, int len) {
+    return((xmlBufferAdd(ctxt, BAD_CAST buffer, len) == 0) ? len : -1);
+}
+
+static int
+testSaveResetFail(void *ctxt ATTRIBUTE_UNUSED,
+                  const char *buffer ATTRIBUTE_UNUSED,
+                  int len ATTRIBUTE_UNUSED) {
+    return(-XML_IO_EIO);
+}
+
+/*
+ * A reset context must produce the same output as a new one for
+ * every document of a series.
+ */
+static int
+testSaveReset(void) {
+    static const char *const docs[] = {
+        "<doc a='1'><e>text</e><e/></doc>",
+        "<?xml version='1.0' encoding='ISO-8859-1'?>\n"
+        "<doc>caf\xE9</doc>",
+        "<r xmlns='urn:x'>a &amp; b<!-- c --></r>"
+    };
+    static const char *const encodings[] = {
+        NULL, "UTF-8", "UTF-16", "ISO-8859-1"
+    };
+    static const int options[] = { 0, XML_SAVE_FORMAT | XML_SAVE_NO_DECL };
+    size_t e, o, d;
+    int err = 0;
+
+    for (e = 0; e < sizeof(encodings) / sizeof(encodings[0]); e++) {
+        for (o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+            xmlSaveCtxtPtr save = NULL;
+            xmlBufferPtr outs[3];
+
+            for (d = 0; d < 3; d++) {
+                xmlDocPtr doc;
+                xmlSaveCtxtPtr ref;
+                xmlBufferPtr expect;
+                xmlParserErrors code;
+
+                doc = xmlReadDoc(BAD_CAST docs[d], NULL, NULL, 0);
+                outs[d] = xmlBufferCreate();
+
+                expect = xmlBufferCreate();
+                ref = xmlSaveToBuffer(expect, encodings[e], options[o]);
+                xmlSaveDoc(ref, doc);
+                xmlSaveClose(ref);
+
+                /* Alternate between both kinds of outputs */
+                if (save == NULL) {
+                    save = xmlSaveToBuffer(outs[d], encodings[e],
+                                           options[o]);
+                    code = XML_ERR_OK;
+                } else if (d == 1) {
+                    testSaveResetCloses = 0;
+                    code = xmlSaveCtxtReset(save, testSaveResetWrite,
+                                            testSaveResetClose, outs[d]);
+                } else {
+                    code = xmlSaveCtxtResetBuffer(save, outs[d]);
+                }
+                xmlSaveDoc(save, doc);
+
+                if (code != XML_ERR_OK) {
+                    fprintf(stderr, "testSaveReset: reset failed\n");
+                    err = 1;
+                }
+                xmlSaveFlush(save);
+                xmlFreeDoc(doc);
+
+                if (d == 2) {
+                    if (xmlSaveFinish(save) != XML_ERR_OK) {
+                        fprintf(stderr, "testSaveReset: finish failed\n");
+                        err = 1;
+                    }
+                    if (testSaveResetCloses != 1) {
+                        fprintf(stderr, "testSaveReset: close callback "
+                                "called %d times\n", testSaveResetCloses);
+                        err = 1;
+                    }
+                }
+                if ((xmlBufferLength(outs[d]) != xmlBufferLength(expect)) ||
+                    (memcmp(xmlBufferContent(outs[d]),
+                            xmlBufferContent(expect),
+                            xmlBufferLength(expect)) != 0)) {
+                    fprintf(stderr, "testSaveReset: output differs "
+                            "(encoding %s, options %d, doc %d)\n",
+                            encodings[e] ? encodings[e] : "none",
+                            options[o], (int) d);
+                    err = 1;
+                }
+                xmlBufferFree(expect);
+            }
+
+            for (d = 0; d < 3; d++)
+                xmlBufferFree(outs[d]);
+        }
+    }
+
+    /* The error of a failed output is reported, the next one works */
+    {
+        xmlDocPtr doc = xmlReadDoc(BAD_CAST docs[0], NULL, NULL, 0);
+        xmlBufferPtr out = xmlBufferCreate();
+        xmlBufferPtr expect = xmlBufferCreate();
+        xmlSaveCtxtPtr save;
+
+        save = xmlSaveToBuffer(expect, "UTF-16", 0);
+        xmlSaveDoc(save, doc);
+        xmlSaveClose(save);
+
+        save = xmlSaveToIO(testSaveResetFail, NULL, NULL, "UTF-16", 0);
+        xmlSaveDoc(save, doc);
+        if (xmlSaveCtxtResetBuffer(save, out) != XML_IO_EIO) {
+            fprintf(stderr, "testSaveReset: write error not reported\n");
+            err = 1;
+        }
+        xmlSaveDoc(save, doc);
+        if ((xmlSaveFinish(save) != XML_ERR_OK) ||
+            (xmlBufferLength(out) != xmlBufferLength(expect)) ||
+            (memcmp(xmlBufferContent(out), xmlBufferContent(expect),
+                    xmlBufferLength(expect)) != 0)) {
+            fprintf(stderr, "testSaveReset: output after error differs\n");
+            err = 1;
+        }
+
+        xmlBufferFree(expect);
+        xmlBufferFree(out);
+        xmlFreeDoc(doc);
+    }
+
+    return(err);
+}
+
+static int
+testSourceSpansCheck(xmlNodePtr node, const char *expected,
+                     const char *what) {
+    xmlBufferPtr buf;
+    int err = 0;
+
+    buf = xmlBufferCreate();
+    xmlNodeDump(buf, node->doc, node, 0, 0);
+    if (strcmp((const char *) xmlBufferContent(buf), expected) != 0) {
+        fprintf(stderr, "testSourceSpans: %s: got %s\n", what,
+                (const char *) xmlBufferContent(buf));
+        err = 1;
+    }
+    xmlBufferFree(buf);
+
+    return(err);
+}
+
+static int
+testSourceSpans(void) {
+    const char docContent[] =
+        "<doc  a='1'>\n"
+        "  <keep x = \"&#65;\" y='&amp;'>t&#x42; <![CDATA[c]]></keep>\n"
+        "  <mod b='2'><inner  c='3'/></mod>\n"
+        "  <gone/>\n"
+        "</doc>\n";
+    const char keepSrc[] =
+        "<keep x = \"&#65;\" y='&amp;'>t&#x42; <![CDATA[c]]></keep>";
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlNodePtr root, keep, mod, inner, gone;
+    const xmlChar *text;
+    size_t len;
+    FILE *tmp;
+    int err = 0;
+
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetSourceSpans(ctxt, 1);
+    doc = xmlCtxtReadMemory(ctxt, docContent, sizeof(docContent) - 1,
+                            NULL, NULL, 0);
+    root = xmlDocGetRootElement(doc);
+    keep = xmlFirstElementChild(root);
+    mod = xmlNextElementSibling(keep);
+    inner = xmlFirstElementChild(mod);
+    gone = xmlNextElementSibling(mod);
+
+    text = xmlNodeGetSource(keep, &len);
+    if ((text == NULL) || (len != sizeof(keepSrc) - 1) ||
+        (memcmp(text, keepSrc, len) != 0)) {
+        fprintf(stderr, "testSourceSpans: wrong source text\n");
+        err = 1;
+    }
+    err |= testSourceSpansCheck(root, "<doc  a='1'>\n"
+        "  <keep x = \"&#65;\" y='&amp;'>t&#x42; <![CDATA[c]]></keep>\n"
+        "  <mod b='2'><inner  c='3'/></mod>\n"
+        "  <gone/>\n"
+        "</doc>", "unmodified");
+
+    xmlSetProp(inner, BAD_CAST "c", BAD_CAST "4");
+    xmlUnlinkNode(gone);
+    xmlFreeNode(gone);
+    xmlNewChild(root, NULL, BAD_CAST "new", NULL);
+    if ((xmlNodeGetSource(mod, &len) != NULL) ||
+        (xmlNodeGetSource(root, &len) != NULL) ||
+        (xmlNodeGetSource(keep, &len) == NULL)) {
+        fprintf(stderr, "testSourceSpans: modification not tracked\n");
+        err = 1;
+    }
+    err |= testSourceSpansCheck(root, "<doc a=\"1\">\n"
+        "  <keep x = \"&#65;\" y='&amp;'>t&#x42; <![CDATA[c]]></keep>\n"
+        "  <mod b=\"2\"><inner c=\"4\"/></mod>\n"
+        "  \n"
+        "<new/></doc>", "modified");
+
+    keep->children->content[0] = 'T';
+    xmlNodeMarkModified(keep->children);
+    err |= testSourceSpansCheck(keep,
+        "<keep x=\"A\" y=\"&amp;\">TB <![CDATA[c]]></keep>", "marked");
+
+    xmlNodeSetName(inner, BAD_CAST "renamed");
+    xmlDocDiscardSource(doc);
+    if (doc->source != NULL) {
+        fprintf(stderr, "testSourceSpans: source not discarded\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+
+    /* Documents with errors keep no source */
+    doc = xmlCtxtReadMemory(ctxt, "<doc><a></doc>", 14, NULL, NULL,
+                            XML_PARSE_RECOVER | XML_PARSE_NOERROR);
+    if ((doc == NULL) || (doc->source != NULL)) {
+        fprintf(stderr, "testSourceSpans: source kept after error\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+
+    /* Memory-mapped input */
+    tmp = tmpfile();
+    if (tmp != NULL) {
+        fputs(docContent, tmp);
+        fflush(tmp);
+        rewind(tmp);
+        doc = xmlCtxtReadFd(ctxt, fileno(tmp), "tmp.xml", NULL,
+                            XML_PARSE_MMAP);
+        keep = xmlFirstElementChild(xmlDocGetRootElement(doc));
+        text = xmlNodeGetSource(keep, &len);
+        if ((text == NULL) || (len != sizeof(keepSrc) - 1) ||
+            (memcmp(text, keepSrc, len) != 0)) {
+            fprintf(stderr, "testSourceSpans: wrong mmap source text\n");
+            err = 1;
+        }
+        xmlFreeDoc(doc);
+        fclose(tmp);
+    }
+
+    xmlFreeParserCtxt(ctxt);
+    return(err);
+}
+
+static int
+testSourceSpansTree(const char *content, int options, const char *expected,
+                    const char *what) {
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlNodePtr root, keep, changed;
+    size_t len;
+    int err = 0;
+
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetSourceSpans(ctxt, 1);
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST content, NULL, NULL, options);
+    root = xmlDocGetRootElement(doc);
+    if ((doc == NULL) || (doc->source == NULL) || (root == NULL)) {
+        fprintf(stderr, "testSourceSpans: %s: parsing failed\n", what);
+        xmlFreeDoc(doc);
+        xmlFreeParserCtxt(ctxt);
+        return(1);
+    }
+    keep = xmlFirstElementChild(root);
+    changed = xmlNextElementSibling(keep);
+
+    /* Elements which don't match their source and ancestors get no span */
+    if ((xmlNodeGetSource(keep, &len) == NULL) ||
+        (xmlNodeGetSource(changed, &len) != NULL) ||
+        (xmlNodeGetSource(root, &len) != NULL)) {
+        fprintf(stderr, "testSourceSpans: %s: wrong spans\n", what);
+        err = 1;
+    }
+    err |= testSourceSpansCheck(root, expected, what);
+
+    xmlFreeDoc(doc);
+    xmlFreeParserCtxt(ctxt);
+    return(err);
+}
+
+static int
+testSourceSpansDefaults(void) {
+    const char *attrs =
+        "<!DOCTYPE doc [<!ATTLIST def d CDATA 'dv'>]>\n"
+        "<doc><keep  k='1'/><def  a='1'><i/></def></doc>";
+    const char *ns =
+        "<!DOCTYPE doc [<!ATTLIST ns xmlns:p CDATA 'urn:p'>]>\n"
+        "<doc><keep  k='1'/><ns  a='1'><p:x/></ns></doc>";
+    int err = 0;
+
+    err |= testSourceSpansTree(attrs, XML_PARSE_DTDATTR,
+        "<doc><keep  k='1'/><def a=\"1\" d=\"dv\"><i/></def></doc>",
+        "default attribute");
+    err |= testSourceSpansTree(ns, 0,
+        "<doc><keep  k='1'/><ns xmlns:p=\"urn:p\" a=\"1\"><p:x/></ns></doc>",
+        "default namespace");
+#ifdef LIBXML_SAX1_ENABLED
+    err |= testSourceSpansTree(attrs, XML_PARSE_DTDATTR | XML_PARSE_SAX1,
+        "<doc><keep  k='1'/><def d=\"dv\" a=\"1\"><i/></def></doc>",
+        "SAX1 default attribute");
+#endif
+
+    return(err);
+}
+
+static int
+testSourceSpansEntities(void) {
+    const char *content =
+        "<!DOCTYPE doc [<!ENTITY e 'ent'>]>\n"
+        "<doc><keep  k='1'/><c>x&e;y<i/></c></doc>";
+    const char *attr =
+        "<!DOCTYPE doc [<!ENTITY e 'ent'>]>\n"
+        "<doc><keep  k='1'/><a  v='&e;'/></doc>";
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    size_t len;
+    int err = 0;
+
+    err |= testSourceSpansTree(content, XML_PARSE_NOENT,
+        "<doc><keep  k='1'/><c>xenty<i/></c></doc>",
+        "substituted entity");
+    err |= testSourceSpansTree(attr, XML_PARSE_NOENT,
+        "<doc><keep  k='1'/><a v=\"ent\"/></doc>",
+        "substituted entity in attribute");
+
+    /* Entity references are kept in the tree without NOENT */
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetSourceSpans(ctxt, 1);
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST content, NULL, NULL, 0);
+    if ((doc == NULL) ||
+        (xmlNodeGetSource(xmlDocGetRootElement(doc), &len) == NULL)) {
+        fprintf(stderr, "testSourceSpans: entity reference not kept\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+    xmlFreeParserCtxt(ctxt);
+
+    return(err);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+#ifdef LIBXML_SAX1_ENABLED
+static int
+testBalancedChunk(void) {
+    xmlNodePtr list;
+    xmlNodePtr elem;
+    int ret;
+    int err = 0;
+
+    ret = xmlParseBalancedChunkMemory(NULL, NULL, NULL, 0,
+            BAD_CAST "start <node xml:lang='en'>abc</node> end", &list);
+
+    if ((ret != XML_ERR_OK) ||
+        (list == NULL) ||
+        ((elem = list->next) == NULL) ||
+        (elem->type != XML_ELEMENT_NODE) ||
+        (elem->nsDef == NULL) ||
+        (!xmlStrEqual(elem->nsDef->href, XML_XML_NAMESPACE))) {
+        fprintf(stderr, "xmlParseBalancedChunkMemory failed\n");
+        err = 1;
+    }
+
+    xmlFreeNodeList(list);
+
+    return(err);
+}
+#endif
+
+#ifdef LIBXML_PUSH_ENABLED
+static int
+testHugePush(void) {
+    xmlParserCtxtPtr ctxt;
+    int err, i;
+
+    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+
+    /*
+     * Push parse a document larger than XML_MAX_LOOKUP_LIMIT
+     * (10,000,000 bytes). This mainly tests whether shrinking the
+     * buffer works when push parsing.
+     */
+    xmlParseChunk(ctxt, "<doc>", 5, 0);
+    for (i = 0; i < 1000000; i++)
+        xmlParseChunk(ctxt, "<elem>text</elem>", 17, 0);
+    xmlParseChunk(ctxt, "</doc>", 6, 1);
+
+    err = ctxt->wellFormed ? 0 : 1;
+    xmlFreeDoc(ctxt->myDoc);
+    xmlFreeParserCtxt(ctxt);
+
+    return err;
+}
+
+static int
+testHugeEncodedChunk(void) {
+    xmlBufferPtr buf;
+    xmlChar *chunk;
+    xmlParserCtxtPtr ctxt;
+    int err = 0, i;
+
+    /*
+     * Test the push parser with a built-in encoding handler like ISO-8859-1
+     * and a chunk larger than the initial decoded buffer (currently 4 KB).
+     */
+    buf = xmlBufferCreate();
+    xmlBufferCat(buf,
+            BAD_CAST "<?xml version='1.0' encoding='ISO-8859-1'?>\n");
+    xmlBufferCat(buf, BAD_CAST "<doc><!-- ");
+    for (i = 0; i < 2000; i++)
+        xmlBufferCat(buf, BAD_CAST "0123456789");
+    xmlBufferCat(buf, BAD_CAST " --></doc>");
+    chunk = xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+
+    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+
+    xmlParseChunk(ctxt, (char *) chunk, xmlStrlen(chunk), 0);
+    xmlParseChunk(ctxt, NULL, 0, 1);
+
+    if (!ctxt->wellFormed)
+        err = 1;
+    xmlFreeDoc(ctxt->myDoc);
+    xmlFreeParserCtxt(ctxt);
+    xmlFree(chunk);
+
+    /*
+     * Test the push parser with
+     *
+     * - a single call to xmlParseChunk,
+     * - a non-UTF8 encoding,
+     * - a chunk larger then MINLEN (4000 bytes).
+     *
+     * This verifies that the whole buffer is processed in the initial
+     * charset conversion.
+     */
+    buf = xmlBufferCreate();
+    xmlBufferCat(buf,
+            BAD_CAST "<?xml version='1.0' encoding='ISO-8859-1'?>\n");
+    xmlBufferCat(buf, BAD_CAST "<doc>");
+    /* 20,000 characters */
+    for (i = 0; i < 2000; i++)
+        xmlBufferCat(buf, BAD_CAST "0123456789");
+    xmlBufferCat(buf, BAD_CAST "</doc>");
+    chunk = xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+
+    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+
+    xmlParseChunk(ctxt, (char *) chunk, xmlStrlen(chunk), 1);
+
+    if (!ctxt->wellFormed)
+        err = 1;
+    xmlFreeDoc(ctxt->myDoc);
+    xmlFreeParserCtxt(ctxt);
+    xmlFree(chunk);
+
+    return err;
+}
+
+static int
+testPushCDataEnd(void) {
+    int err = 0;
+    int k;
+
+    for (k = 0; k < 4; k++) {
+        xmlBufferPtr buf;
+        xmlChar *chunk;
+        xmlParserCtxtPtr ctxt;
+        int i;
+
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        xmlCtxtSetOptions(ctxt, XML_PARSE_NOERROR);
+
+        /*
+         * Push parse text data with ']]>' split across chunks.
+         */
+        buf = xmlBufferCreate();
+        xmlBufferCCat(buf, "<doc>");
+
+        /*
+         * Also test xmlParseCharDataCopmlex
+         */
+        if (k & 1)
+            xmlBufferCCat(buf, "x");
+        else
+            xmlBufferCCat(buf, "\xC3\xA4");
+
+        /*
+         * Create enough data to trigger a "characters" SAX callback.
+         * (XML_PARSER_BIG_BUFFER_SIZE = 300)
+         */
+        for (i = 0; i < 2000; i++)
+            xmlBufferCCat(buf, "x");
+
+        if (k & 2)
+            xmlBufferCCat(buf, "]");
+        else
+            xmlBufferCCat(buf, "]]");
+
+        chunk = xmlBufferDetach(buf);
+        xmlBufferFree(buf);
+
+        xmlParseChunk(ctxt, (char *) chunk, xmlStrlen(chunk), 0);
+        if (k & 2)
+            xmlParseChunk(ctxt, "]>xxx</doc>", 11, 1);
+        else
+            xmlParseChunk(ctxt, ">xxx</doc>", 10, 1);
+
+        if (ctxt->errNo != XML_ERR_MISPLACED_CDATA_END) {
+            fprintf(stderr, "xmlParseChunk failed to detect CData end: %d\n",
+                    ctxt->errNo);
+            err = 1;
+        }
+
+        xmlFree(chunk);
+        xmlFreeDoc(ctxt->myDoc);
+        xmlFreeParserCtxt(ctxt);
+    }
+
+    return err;
+}
+
+static int
+testPushTextMerge(void) {
+    xmlFreeFunc freeFunc;
+    xmlMallocFunc mallocFunc;
+    xmlReallocFunc reallocFunc;
+    xmlStrdupFunc strdupFunc;
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    xmlChar *content;
+    char chunk[100];
+    int before, used;
+    int err = 0;
+    int i;
+
+    xmlMemGet(&freeFunc, &mallocFunc, &reallocFunc, &strdupFunc);
+    xmlMemSetup(xmlMemFree, xmlMemMalloc, xmlMemRealloc, xmlMemoryStrdup);
+    before = xmlMemUsed();
+
+    /*
+     * Text arriving in many small chunks is merged into a single
+     * node without keeping the slack of the growing buffer.
+     */
+    memset(chunk, 'x', sizeof(chunk));
+    ctxt = xmlCreatePushParserCtxt(NULL, NULL, "<doc>", 5, NULL);
+    for (i = 0; i < 1000; i++)
+        xmlParseChunk(ctxt, chunk, sizeof(chunk), 0);
+    xmlParseChunk(ctxt, "<!--c-->yz</doc>", 16, 1);
+    doc = ctxt->myDoc;
+    xmlFreeParserCtxt(ctxt);
+
+    root = xmlDocGetRootElement(doc);
+    if ((root == NULL) || (root->children == NULL) ||
+        (root->children->type != XML_TEXT_NODE) ||
+        (xmlStrlen(root->children->content) != 100000) ||
+        (root->children->next == NULL) ||
+        (root->children->next->next == NULL) ||
+        (!xmlStrEqual(root->children->next->next->content, BAD_CAST "yz"))) {
+        fprintf(stderr, "testPushTextMerge: wrong tree\n");
+        err = 1;
+    } else {
+        content = root->children->content;
+        for (i = 0; i < 100000; i++) {
+            if (content[i] != 'x') {
+                fprintf(stderr, "testPushTextMerge: wrong content\n");
+                err = 1;
+                break;
+            }
+        }
+    }
+
+    used = xmlMemUsed() - before;
+    if (used > 110000) {
+        fprintf(stderr, "testPushTextMerge: document uses %d bytes\n",
+                used);
+        err = 1;
+    }
+
+    xmlFreeDoc(doc);
+    xmlMemSetup(freeFunc, mallocFunc, reallocFunc, strdupFunc);
+
+    return(err);
+}
+
+/* Root attributes, an attribute of the first child and the text */
+static xmlChar *
+pushLookaheadSummary(xmlDocPtr doc) {
+    xmlNodePtr root = xmlDocGetRootElement(doc);
+    xmlNodePtr e;
+    xmlChar *ret, *tmp;
+
+    if (root == NULL)
+        return(NULL);
+    e = xmlFirstElementChild(root);
+    if (e == NULL)
+        return(NULL);
+
+    ret = xmlGetProp(root, BAD_CAST "a");
+    tmp = xmlGetProp(root, BAD_CAST "b");
+    ret = xmlStrcat(ret, tmp);
+    xmlFree(tmp);
+    tmp = xmlGetProp(e, BAD_CAST "c");
+    ret = xmlStrcat(ret, tmp);
+    xmlFree(tmp);
+    tmp = xmlNodeGetContent(root);
+    ret = xmlStrcat(ret, tmp);
+    xmlFree(tmp);
+
+    return(ret);
+}
+
+static int
+testPushLookahead(void) {
+    static const char data[] =
+        "<doc a='x>y\"z>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>' "
+        "b=\"p>'q \xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4\xC3\xA4"
+        "\xC3\xA4 >>>>>>>>>>>>>>>>>>>>>>>\">"
+        "text &amp; more text with many characters before the tag"
+        "<e c='>>>' d=\"'\"/><!-- c > - -->tail</doc>";
+    static const int sizes[] = { 1, 3, 7, 16, 17, 1000 };
+    xmlDocPtr doc;
+    xmlChar *ref;
+    size_t i;
+    int err = 0;
+
+    doc = xmlReadMemory(data, sizeof(data) - 1, NULL, NULL, 0);
+    ref = pushLookaheadSummary(doc);
+    xmlFreeDoc(doc);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        xmlParserCtxtPtr ctxt;
+        xmlNodePtr root;
+        xmlChar *summary;
+        int off;
+
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        for (off = 0; off < (int) sizeof(data) - 2; off += sizes[i]) {
+            int len = sizeof(data) - 2 - off;
+
+            if (len > sizes[i])
+                len = sizes[i];
+            xmlParseChunk(ctxt, data + off, len, 0);
+        }
+
+        /* Everything before the end tag must be parsed by now */
+        doc = ctxt->myDoc;
+        root = xmlDocGetRootElement(doc);
+        if ((root == NULL) || (root->last == NULL) ||
+            (!xmlStrEqual(root->last->content, BAD_CAST "tail"))) {
+            fprintf(stderr, "testPushLookahead: content not parsed with "
+                    "chunk size %d\n", sizes[i]);
+            err = 1;
+        }
+
+        xmlParseChunk(ctxt, data + sizeof(data) - 2, 1, 1);
+
+        summary = pushLookaheadSummary(doc);
+        if ((!ctxt->wellFormed) || (ref == NULL) ||
+            (!xmlStrEqual(summary, ref))) {
+            fprintf(stderr, "testPushLookahead: wrong result with chunk "
+                    "size %d\n", sizes[i]);
+            err = 1;
+        }
+
+        xmlFree(summary);
+        xmlFreeDoc(doc);
+        xmlFreeParserCtxt(ctxt);
+    }
+
+    xmlFree(ref);
+
+    return(err);
+}
+
+static int
+borrowedLinesEqual(xmlNodePtr a, xmlNodePtr b) {
+    while ((a != NULL) && (b != NULL)) {
+        if ((a->type != b->type) || (xmlGetLineNo(a) != xmlGetLineNo(b)))
+            return(0);
+        if (!borrowedLinesEqual(a->children, b->children))
+            return(0);
+        a = a->next;
+        b = b->next;
+    }
+    return(a == b);
+}
+
+static int
+testPushBorrowed(void) {
+    static const int sizes[] = { 1, 5, 64, 5000, 100000 };
+    xmlBufferPtr data;
+    xmlDocPtr ref, doc;
+    xmlChar *refDump, *dump;
+    char *scratch;
+    int refLen, len, dataLen;
+    size_t i;
+    int j, err = 0;
+
+    data = xmlBufferCreate();
+    xmlBufferCCat(data, "<?xml version='1.0'?>\n<doc a='1'>\n");
+    for (j = 0; j < 200; j++) {
+        char tmp[100];
+
+        snprintf(tmp, sizeof(tmp),
+                 "  <e n='%d'>text &amp; <![CDATA[c%d]]></e><!--%d-->\n",
+                 j, j, j);
+        xmlBufferCCat(data, tmp);
+    }
+    /* Longer than the prefix copied to complete leftover data */
+    xmlBufferCCat(data, "<long v='");
+    for (j = 0; j < 12000; j++)
+        xmlBufferCCat(data, "v");
+    xmlBufferCCat(data, "'/>\r\n</doc>\n");
+    dataLen = xmlBufferLength(data);
+
+    ref = xmlReadMemory((const char *) xmlBufferContent(data), dataLen,
+                        NULL, NULL, 0);
+    xmlDocDumpMemory(ref, &refDump, &refLen);
+
+    scratch = xmlMalloc(dataLen + 1);
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        xmlParserCtxtPtr ctxt;
+        int off;
+
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        for (off = 0; off < dataLen; off += sizes[i]) {
+            int n = dataLen - off;
+
+            if (n > sizes[i])
+                n = sizes[i];
+            memcpy(scratch, xmlBufferContent(data) + off, n);
+            scratch[n] = 0;
+            xmlParseChunkBorrowed(ctxt, scratch, n, 0);
+            /* The parser must not keep references to the chunk */
+            memset(scratch, '#', n);
+        }
+        xmlParseChunkBorrowed(ctxt, NULL, 0, 1);
+
+        doc = ctxt->myDoc;
+        xmlDocDumpMemory(doc, &dump, &len);
+        if ((!ctxt->wellFormed) || (refDump == NULL) ||
+            (!xmlStrEqual(dump, refDump)) ||
+            (!borrowedLinesEqual(doc->children, ref->children))) {
+            fprintf(stderr, "testPushBorrowed: wrong result with chunk "
+                    "size %d\n", sizes[i]);
+            err = 1;
+        }
+
+        xmlFree(dump);
+        xmlFreeDoc(doc);
+        xmlFreeParserCtxt(ctxt);
+    }
+
+    xmlFree(scratch);
+    xmlFree(refDump);
+    xmlFreeDoc(ref);
+    xmlBufferFree(data);
+
+    return(err);
+}
+
+typedef struct {
+    int nbDocs;
+    int stopAfter;
+    xmlChar *dumps[4];
+    int status[4];
+} testDocStreamState;
+
+static int
+testDocStreamFunc(void *data, xmlDocPtr doc, int status) {
+    testDocStreamState *state = data;
+    int len;
+
+    if (state->nbDocs < 4) {
+        xmlDocDumpMemory(doc, &state->dumps[state->nbDocs], &len);
+        state->status[state->nbDocs] = status;
+    }
+    state->nbDocs++;
+    xmlFreeDoc(doc);
+
+    return((state->nbDocs == state->stopAfter) ? -1 : 0);
+}
+
+static int
+testDocStream(void) {
+    static const char *const docs[] = {
+        "<?xml version='1.0' encoding='UTF-8'?>\n"
+        "<a xmlns='urn:a'><b x='1'>text &amp; more</b></a>",
+        "<!-- between -->\n"
+        "<!DOCTYPE r [<!ATTLIST r d CDATA 'def'>]><r/>",
+        "<?xml version='1.0'?><r><p:c xmlns:p='urn:p'>\xC3\xA4</p:c></r>"
+    };
+    static const int sizes[] = { 1, 3, 17, 1000 };
+    xmlChar *refs[3];
+    char stream[1000];
+    size_t i;
+    int j, len, off, streamLen = 0;
+    int err = 0;
+
+    for (j = 0; j < 3; j++) {
+        xmlDocPtr doc = xmlReadDoc(BAD_CAST docs[j], NULL, NULL, 0);
+
+        xmlDocDumpMemory(doc, &refs[j], &len);
+        xmlFreeDoc(doc);
+        streamLen += snprintf(stream + streamLen, sizeof(stream) - streamLen,
+                              "%s\n\n", docs[j]);
+    }
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        testDocStreamState state;
+        xmlParserCtxtPtr ctxt;
+        int ret;
+
+        memset(&state, 0, sizeof(state));
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        xmlCtxtSetDocStream(ctxt, testDocStreamFunc, &state);
+
+        for (off = 0; off < streamLen; off += sizes[i]) {
+            int n = streamLen - off;
+
+            if (n > sizes[i])
+                n = sizes[i];
+            xmlParseChunk(ctxt, stream + off, n, 0);
+
+            /* Documents are passed on once the root element ends */
+            if ((off + n == (int) strlen(docs[0])) && (state.nbDocs != 1)) {
+                fprintf(stderr, "testDocStream: first document not passed "
+                        "on with chunk size %d\n", sizes[i]);
+                err = 1;
+            }
+        }
+        ret = xmlParseChunk(ctxt, NULL, 0, 1);
+
+        if ((ret != 0) || (state.nbDocs != 3) || (ctxt->myDoc != NULL)) {
+            fprintf(stderr, "testDocStream: got %d documents, error %d with "
+                    "chunk size %d\n", state.nbDocs, ret, sizes[i]);
+            err = 1;
+        }
+        for (j = 0; j < state.nbDocs && j < 3; j++) {
+            if ((state.status[j] != 0) ||
+                (!xmlStrEqual(state.dumps[j], refs[j]))) {
+                fprintf(stderr, "testDocStream: document %d differs with "
+                        "chunk size %d\n", j, sizes[i]);
+                err = 1;
+            }
+            xmlFree(state.dumps[j]);
+        }
+
+        xmlFreeParserCtxt(ctxt);
+    }
+
+    /* The callback can stop the parser */
+    {
+        testDocStreamState state;
+        xmlParserCtxtPtr ctxt;
+        int ret;
+
+        memset(&state, 0, sizeof(state));
+        state.stopAfter = 2;
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        xmlCtxtSetDocStream(ctxt, testDocStreamFunc, &state);
+        ret = xmlParseChunk(ctxt, stream, streamLen, 1);
+        if ((ret != XML_ERR_USER_STOP) || (state.nbDocs != 2)) {
+            fprintf(stderr, "testDocStream: callback didn't stop parser\n");
+            err = 1;
+        }
+        for (j = 0; j < state.nbDocs; j++)
+            xmlFree(state.dumps[j]);
+        xmlFreeDoc(ctxt->myDoc);
+        xmlFreeParserCtxt(ctxt);
+    }
+
+    for (j = 0; j < 3; j++)
+        xmlFree(refs[j]);
+
+    return(err);
+}
+#endif /* PUSH */
+
+typedef struct {
+    int nodes;
+    int size;
+    int maxChunk;
+} testTextSinkState;
+
+static int
+testTextSinkFunc(void *data, xmlNodePtr node, const xmlChar *chunk,
+                 int len, int more) {
+    testTextSinkState *state = data;
+    char ref[20];
+
+    if (more) {
+        if (memchr(chunk, 0, len) != NULL)
+            return(-1);
+        state->size += len;
+        if (len > state->maxChunk)
+            state->maxChunk = len;
+    } else {
+        snprintf(ref, sizeof(ref), "blob:%d", state->nodes++);
+        xmlNodeSetContent(node, BAD_CAST ref);
+    }
+    return(0);
+}
+
+static int
+testTextSink(void) {
+    const int textLen = 300000, cdataLen = 200000;
+    testTextSinkState state;
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlNodePtr root, cur;
+    char *xml, *p;
+    int err = 0;
+
+    xml = xmlMalloc(textLen + cdataLen + 100);
+    p = xml;
+    p += sprintf(p, "<doc><a>");
+    memset(p, 'x', textLen / 2);
+    p += textLen / 2;
+    p += sprintf(p, "&amp;");
+    memset(p, 'x', textLen / 2 - 1);
+    p += textLen / 2 - 1;
+    p += sprintf(p, "</a><b><![CDATA[");
+    memset(p, 'y', cdataLen);
+    p += cdataLen;
+    p += sprintf(p, "]]></b><c>short</c></doc>");
+
+    /* Chunked CDATA sections are merged into a single node */
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetChunkedText(ctxt, 1);
+    doc = xmlCtxtReadMemory(ctxt, xml, p - xml, NULL, NULL, 0);
+    root = xmlDocGetRootElement(doc);
+    cur = (root != NULL) ? root->children->next : NULL;
+    if ((cur == NULL) || (cur->children == NULL) ||
+        (cur->children->type != XML_CDATA_SECTION_NODE) ||
+        (cur->children->next != NULL) ||
+        (xmlStrlen(cur->children->content) != cdataLen)) {
+        fprintf(stderr, "testTextSink: chunked CDATA not merged\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+    xmlFreeParserCtxt(ctxt);
+
+    /* Large nodes go to the sink, without XML_PARSE_HUGE */
+    memset(&state, 0, sizeof(state));
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetTextSink(ctxt, 1000, testTextSinkFunc, &state);
+    doc = xmlCtxtReadMemory(ctxt, xml, p - xml, NULL, NULL, 0);
+    root = xmlDocGetRootElement(doc);
+    if ((root == NULL) ||
+        (!xmlStrEqual(root->children->children->content,
+                      BAD_CAST "blob:0")) ||
+        (!xmlStrEqual(root->children->next->children->content,
+                      BAD_CAST "blob:1")) ||
+        (!xmlStrEqual(root->last->children->content, BAD_CAST "short"))) {
+        fprintf(stderr, "testTextSink: wrong tree\n");
+        err = 1;
+    }
+    if ((state.nodes != 2) || (state.size != textLen + cdataLen) ||
+        (state.maxChunk >= cdataLen)) {
+        fprintf(stderr, "testTextSink: got %d nodes, %d bytes, "
+                "chunks up to %d bytes\n",
+                state.nodes, state.size, state.maxChunk);
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+    xmlFreeParserCtxt(ctxt);
+
+    xmlFree(xml);
+    return(err);
+}
+
+#ifdef LIBXML_HTML_ENABLED
+static int
+testLazyLinesCompare(xmlNodePtr a, xmlNodePtr b) {
+    int err = 0;
+
+    while ((a != NULL) && (b != NULL)) {
+        if ((a->type != b->type) || (xmlGetLineNo(a) != xmlGetLineNo(b))) {
+            fprintf(stderr, "testLazyLines: node on line %ld, expected %ld\n",
+                    xmlGetLineNo(b), xmlGetLineNo(a));
+            return(1);
+        }
+        err |= testLazyLinesCompare(a->children, b->children);
+        a = a->next;
+        b = b->next;
+    }
+    if (a != b) {
+        fprintf(stderr, "testLazyLines: trees differ\n");
+        err = 1;
+    }
+
+    return(err);
+}
+
+static xmlDocPtr
+testLazyLinesParse(const char *xml, int size, int lazy, int push,
+                   int *line, int *col) {
+    xmlParserCtxtPtr ctxt;
+    const xmlError *error;
+    xmlDocPtr doc;
+
+    if (push) {
+        int i;
+
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        xmlCtxtSetLazyLines(ctxt, lazy);
+        xmlCtxtUseOptions(ctxt, XML_PARSE_RECOVER | XML_PARSE_NOERROR);
+        for (i = 0; i < size; i += 37)
+            xmlParseChunk(ctxt, xml + i, size - i < 37 ? size - i : 37, 0);
+        xmlParseChunk(ctxt, NULL, 0, 1);
+        doc = ctxt->myDoc;
+        ctxt->myDoc = NULL;
+    } else {
+        ctxt = xmlNewParserCtxt();
+        xmlCtxtSetLazyLines(ctxt, lazy);
+        doc = xmlCtxtReadMemory(ctxt, xml, size, NULL, NULL,
+                                XML_PARSE_RECOVER | XML_PARSE_NOERROR);
+    }
+
+    error = xmlCtxtGetLastError(ctxt);
+    *line = (error != NULL) ? error->line : 0;
+    *col = (error != NULL) ? error->int2 : 0;
+    xmlFreeParserCtxt(ctxt);
+
+    return(doc);
+}
+
+static int
+testLazyLines(void) {
+    static const char *const parts[] = {
+        "<a x='1\n2'>text\r\nmore \xC3\xA9\n</a>\n",
+        "<!-- c\nc -->\r\n",
+        "<b><![CDATA[x\r\ny]]></b>",
+        "<?pi a\nb?>\r\n",
+        "\t  \n  <c/>",
+        "<d>&amp;\n&#10;\n</d>\n"
+    };
+    char *xml, *p;
+    int size = 0;
+    int push;
+    int i;
+    int err = 0;
+
+    xml = xmlMalloc(100000);
+    p = xml;
+    p += sprintf(p, "<doc>\n");
+    for (i = 0; i < 1000; i++) {
+        const char *part = parts[i % 6];
+
+        memcpy(p, part, strlen(part));
+        p += strlen(part);
+    }
+    p += sprintf(p, "  <e>&undef;</e>\n</doc>\n");
+    size = p - xml;
+
+    for (push = 0; push <= 1; push++) {
+        xmlDocPtr doc, lazyDoc;
+        int line, col, lazyLine, lazyCol;
+
+        doc = testLazyLinesParse(xml, size, 0, push, &line, &col);
+        lazyDoc = testLazyLinesParse(xml, size, 1, push,
+                                     &lazyLine, &lazyCol);
+
+        if ((doc == NULL) || (lazyDoc == NULL)) {
+            fprintf(stderr, "testLazyLines: parse failed\n");
+            err = 1;
+        } else {
+            err |= testLazyLinesCompare(doc->children, lazyDoc->children);
+        }
+        if ((line != lazyLine) || (col != lazyCol) || (line < 1000)) {
+            fprintf(stderr, "testLazyLines: error at %d:%d, expected %d:%d\n",
+                    lazyLine, lazyCol, line, col);
+            err = 1;
+        }
+
+        xmlFreeDoc(doc);
+        xmlFreeDoc(lazyDoc);
+    }
+
+    xmlFree(xml);
+    return(err);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static int
+testParallelParseRun(const char *xml, int size, int nbThreads,
+                     xmlDocPtr *docOut, xmlChar **out, int *nodes,
+                     int *errors) {
+    xmlParserCtxtPtr ctxt;
+    xmlParserStats stats;
+    xmlDocPtr doc;
+    int len;
+
+    ctxt = xmlNewParserCtxt();
+    if ((nbThreads > 1) && (xmlCtxtSetParallel(ctxt, nbThreads) < 0)) {
+        xmlFreeParserCtxt(ctxt);
+        return(-1);
+    }
+    doc = xmlCtxtReadMemory(ctxt, xml, size, "test.xml", NULL,
+                            XML_PARSE_NOERROR);
+    xmlCtxtGetStats(ctxt, &stats);
+    *nodes = stats.nodes;
+    *errors = (xmlCtxtGetLastError(ctxt) != NULL);
+    xmlFreeParserCtxt(ctxt);
+
+    *out = NULL;
+    if (doc != NULL)
+        xmlDocDumpMemory(doc, out, &len);
+    *docOut = doc;
+
+    return(0);
+}
+
+static int
+testParallelParse(void) {
+    char *xml, *p;
+    int variant;
+    int err = 0;
+
+    xml = xmlMalloc(2000000);
+
+    /*
+     * 0: split at top-level records
+     * 1: records nested in a wrapper make the speculation fail
+     * 2: an ID defined twice in different chunks
+     * 3: records in a default namespace
+     */
+    for (variant = 0; variant < 4; variant++) {
+        xmlDocPtr seqDoc, parDoc;
+        xmlChar *seqOut, *parOut;
+        int seqNodes, parNodes, seqErrors, parErrors;
+        int i, size;
+
+        p = xml;
+        p += sprintf(p, "<?xml version='1.0' encoding='UTF-8'?>\n"
+                     "<!-- prolog -->\n<doc xmlns:a='urn:a'\n"
+                     "  %s xml:id='root'>\n%s",
+                     variant == 3 ? "xmlns='urn:d'" : "",
+                     variant == 1 ? "<rec>\n" : "");
+        for (i = 0; i < 10000; i++) {
+            p += sprintf(p, "  <rec xml:id='r%d' a:n='%d' xml:lang='en'>\n"
+                         "    <a:v>text\n%d &amp; more</a:v><![CDATA[<x>]]>"
+                         "<!-- c --><b/>\n  </rec>\n",
+                         (variant == 2 && i == 9000) ? 5 : i, i, i);
+        }
+        p += sprintf(p, "%s</doc>\n<?pi after?>\n<!-- end -->\n",
+                     variant == 1 ? "</rec>" : "");
+        size = p - xml;
+
+        testParallelParseRun(xml, size, 1, &seqDoc, &seqOut, &seqNodes,
+                             &seqErrors);
+        if (testParallelParseRun(xml, size, 4, &parDoc, &parOut, &parNodes,
+                                 &parErrors) < 0) {
+            xmlFreeDoc(seqDoc);
+            xmlFree(seqOut);
+            break;
+        }
+
+        if ((seqErrors != parErrors) || ((seqOut == NULL) != (parOut == NULL)) ||
+            ((seqOut != NULL) &&
+             (strcmp((char *) seqOut, (char *) parOut) != 0))) {
+            fprintf(stderr, "testParallelParse: results differ in "
+                    "variant %d\n", variant);
+            err = 1;
+        } else if ((seqDoc != NULL) && (parDoc != NULL)) {
+            xmlAttrPtr attr;
+
+            err |= testLazyLinesCompare(seqDoc->children, parDoc->children);
+
+            attr = xmlGetID(parDoc, BAD_CAST "r9999");
+            if ((attr == NULL) || (attr->doc != parDoc) ||
+                (xmlGetLineNo(attr->parent) !=
+                 xmlGetLineNo(xmlGetID(seqDoc, BAD_CAST "r9999")->parent)) ||
+                (xmlGetID(parDoc, BAD_CAST "root") == NULL)) {
+                fprintf(stderr, "testParallelParse: IDs differ\n");
+                err = 1;
+            }
+        }
+
+        /* Only a successful parallel parse skips the sequential parser */
+        if ((parNodes == 0) != ((variant == 0) || (variant == 3))) {
+            fprintf(stderr, "testParallelParse: variant %d %s in "
+                    "parallel\n", variant,
+                    parNodes == 0 ? "parsed" : "not parsed");
+            err = 1;
+        }
+
+        xmlFreeDoc(seqDoc);
+        xmlFreeDoc(parDoc);
+        xmlFree(seqOut);
+        xmlFree(parOut);
+    }
+
+    xmlFree(xml);
+    return(err);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_OUTPUT_ENABLED)
+static int
+testPatternFilter(void) {
+    const char *xml =
+        "<!DOCTYPE doc [<!ENTITY e '<sel>ent</sel>'>]>\n"
+        "<!-- prolog -->\n"
+        "<doc xmlns='urn:d' xmlns:p='urn:p' a='1'>\n"
+        "  <skip x='1'>text &e;<!-- c --><?pi?><deep><p:no/></deep></skip>\n"
+        "  <group g='1'><p:item id='i1'>one &e; <b/></p:item><q/></group>\n"
+        "  <p:item id='i2'><![CDATA[two]]></p:item>\n"
+        "  &e;\n"
+        "</doc>\n"
+        "<!-- end -->\n";
+    const char *expected[] = {
+        "<doc xmlns=\"urn:d\" xmlns:p=\"urn:p\"><group>"
+        "<p:item id=\"i1\">one &e; <b/></p:item></group>"
+        "<p:item id=\"i2\"><![CDATA[two]]></p:item></doc>",
+        "<doc xmlns=\"urn:d\" xmlns:p=\"urn:p\"><group>"
+        "<p:item id=\"i1\">one <sel>ent</sel> <b/></p:item></group>"
+        "<p:item id=\"i2\"><![CDATA[two]]></p:item></doc>"
+    };
+    const xmlChar *namespaces[] = {
+        BAD_CAST "urn:d", BAD_CAST "d", BAD_CAST "urn:p", BAD_CAST "p",
+        NULL, NULL
+    };
+    xmlPatternPtr patterns[2];
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    int i;
+    int err = 0;
+
+    patterns[0] = xmlPatterncompile(BAD_CAST "d:group/p:item", NULL, 0,
+                                    namespaces);
+    patterns[1] = xmlPatterncompile(BAD_CAST "/d:doc/p:item", NULL, 0,
+                                    namespaces);
+
+    ctxt = xmlNewParserCtxt();
+    if (xmlCtxtSetPatternFilter(ctxt, patterns, 2) < 0) {
+        fprintf(stderr, "testPatternFilter: setting filter failed\n");
+        err = 1;
+    }
+
+    for (i = 0; i < 2; i++) {
+        xmlBufferPtr buf;
+        xmlNodePtr root;
+
+        doc = xmlCtxtReadDoc(ctxt, BAD_CAST xml, NULL, NULL,
+                             i ? XML_PARSE_NOENT : 0);
+        root = xmlDocGetRootElement(doc);
+        if ((root == NULL) || (doc->children->next->type != XML_COMMENT_NODE) ||
+            (doc->last->type != XML_COMMENT_NODE)) {
+            fprintf(stderr, "testPatternFilter: parsing failed\n");
+            err = 1;
+            xmlFreeDoc(doc);
+            continue;
+        }
+
+        buf = xmlBufferCreate();
+        xmlNodeDump(buf, doc, root, 0, 0);
+        if (strcmp((char *) xmlBufferContent(buf), expected[i]) != 0) {
+            fprintf(stderr, "testPatternFilter: got %s\n",
+                    (char *) xmlBufferContent(buf));
+            err = 1;
+        }
+        xmlBufferFree(buf);
+        xmlFreeDoc(doc);
+    }
+
+    /* Skipped content is still checked for well-formedness */
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST "<doc><a><b></a></doc>", NULL, NULL,
+                         XML_PARSE_NOERROR);
+    if (doc != NULL) {
+        fprintf(stderr, "testPatternFilter: error not detected\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+
+    xmlFreeParserCtxt(ctxt);
+    xmlFreePattern(patterns[0]);
+    xmlFreePattern(patterns[1]);
+    return err;
+}
+#endif /* LIBXML_PATTERN_ENABLED && LIBXML_OUTPUT_ENABLED */
+
+#ifdef LIBXML_PATTERN_ENABLED
+#define PATTERN_SET_SIZE 14
+
+static int
+testPatternSetWalk(xmlNodePtr node, xmlPatternSetStreamPtr set,
+                   xmlStreamCtxtPtr *streams, int *nbMatches) {
+    int err = 0;
+
+    for (; node != NULL; node = node->next) {
+        const xmlChar *ns;
+        const int *ids;
+        int expected, nb, i;
+
+        if (node->type != XML_ELEMENT_NODE)
+            continue;
+        ns = node->ns ? node->ns->href : NULL;
+
+        nb = xmlPatternSetPush(set, node->name, ns, &ids);
+        for (i = 0; i < PATTERN_SET_SIZE; i++) {
+            int found = 0, j;
+
+            expected = streams[i] ? xmlStreamPush(streams[i], node->name, ns) :
+                                    0;
+            for (j = 0; j < nb; j++)
+                if (ids[j] == i)
+                    found = 1;
+            if (found != expected) {
+                fprintf(stderr, "testPatternSet: pattern %d %s %s\n", i,
+                        expected ? "doesn't match" : "matches", node->name);
+                err = 1;
+            }
+        }
+        for (i = 1; i < nb; i++) {
+            if (ids[i - 1] >= ids[i]) {
+                fprintf(stderr, "testPatternSet: IDs not sorted\n");
+                err = 1;
+            }
+        }
+        *nbMatches += nb;
+
+        err |= testPatternSetWalk(node->children, set, streams, nbMatches);
+
+        xmlPatternSetPop(set);
+        for (i = 0; i < PATTERN_SET_SIZE; i++)
+            if (streams[i] != NULL)
+                xmlStreamPop(streams[i]);
+    }
+
+    return err;
+}
+
+static int
+testPatternSet(void) {
+    const char *xml =
+        "<r><a><b><c/><a><c/><b><c/></b></a></b>"
+        "<p:a xmlns:p='urn:p'><b/><c/></p:a></a>"
+        "<c><d/><b><c/></b></c>"
+        "<x xmlns='urn:p'><a/><b><a/></b></x></r>";
+    const char *exprs[PATTERN_SET_SIZE] = {
+        "a", "b/c", "/r/a", "//c", "a//c", "*/c", "p:*", "p:a/b",
+        "/r//b|c/d", "r/*/c", "/r", "p:x//*", "a/b/c", "a/@id"
+    };
+    const xmlChar *namespaces[] = {
+        BAD_CAST "urn:p", BAD_CAST "p", NULL, NULL
+    };
+    xmlPatternPtr patterns[PATTERN_SET_SIZE];
+    xmlStreamCtxtPtr streams[PATTERN_SET_SIZE];
+    xmlPatternSetPtr set;
+    xmlPatternSetStreamPtr stream;
+    xmlDocPtr doc;
+    int nbMatches = 0;
+    int i, pass;
+    int err = 0;
+
+    set = xmlNewPatternSet();
+    for (i = 0; i < PATTERN_SET_SIZE; i++) {
+        int ret;
+
+        patterns[i] = xmlPatterncompile(BAD_CAST exprs[i], NULL, 0,
+                                        namespaces);
+        ret = xmlPatternSetAdd(set, patterns[i], i);
+        /* The last pattern selects attributes */
+        if ((ret < 0) != (i == PATTERN_SET_SIZE - 1)) {
+            fprintf(stderr, "testPatternSet: adding %s returned %d\n",
+                    exprs[i], ret);
+            err = 1;
+        }
+        if (ret < 0) {
+            streams[i] = NULL;
+            continue;
+        }
+        streams[i] = xmlPatternGetStreamCtxt(patterns[i]);
+    }
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    stream = xmlPatternSetGetStreamCtxt(set);
+
+    /* The second pass checks that the stream can be reset */
+    for (pass = 0; pass < 2; pass++) {
+        xmlPatternSetPush(stream, NULL, NULL, NULL);
+        for (i = 0; i < PATTERN_SET_SIZE; i++)
+            if (streams[i] != NULL)
+                xmlStreamPush(streams[i], NULL, NULL);
+        err |= testPatternSetWalk(doc->children, stream, streams,
+                                  &nbMatches);
+    }
+    if (nbMatches == 0) {
+        fprintf(stderr, "testPatternSet: no matches\n");
+        err = 1;
+    }
+
+    xmlFreePatternSetStream(stream);
+    xmlFreeDoc(doc);
+    for (i = 0; i < PATTERN_SET_SIZE; i++) {
+        xmlFreeStreamCtxt(streams[i]);
+        xmlFreePattern(patterns[i]);
+    }
+    xmlFreePatternSet(set);
+    return err;
+}
+#endif /* LIBXML_PATTERN_ENABLED */
+
+/*
+ * Text, attribute values and comments are skipped in vector-sized
+ * blocks. Put special characters at every offset relative to the
+ * block boundaries.
+ */
+static int
+testHtmlDataScan(void) {
+    static const char *const specials[] = {
+        "&amp;", "&#x41;", "\n", "\r\n", "\xC3\xA9", "-", "'", ">"
+    };
+    static const char *const expected[] = {
+        "&", "A", "\n", "\n", "\xC3\xA9", "-", "'", ">"
+    };
+    static const char digits[] =
+        "0123456789012345678901234567890123456789"
+        "0123456789012345678901234567890123456789"
+        "01234567890123456789";
+    static const char letters[] =
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghijabcdefghijabcdefghij"
+        "abcdefghijabcdefghij";
+    char html[1024];
+    char text[256];
+    size_t s;
+    int i;
+    int err = 0;
+
+    for (s = 0; s < sizeof(specials) / sizeof(specials[0]); s++) {
+        for (i = 0; i < 100; i++) {
+            xmlDocPtr doc;
+            xmlNodePtr body, p, comment, end;
+            xmlChar *content;
+            int expectedLine;
+
+            snprintf(text, sizeof(text), "%.*s%s%.*s",
+                     i, digits, specials[s], 100 - i, letters);
+            snprintf(html, sizeof(html),
+                     "<body><p title=\"%s\">%s</p><!--%s--><i></i>",
+                     text, text, text);
+            snprintf(text, sizeof(text), "%.*s%s%.*s",
+                     i, digits, expected[s], 100 - i, letters);
+
+            doc = htmlReadDoc(BAD_CAST html, NULL, "UTF-8",
+                              HTML_PARSE_NOERROR);
+            body = xmlDocGetRootElement(doc);
+            if (body != NULL)
+                body = xmlGetLastChild(body);
+            if (body == NULL) {
+                fprintf(stderr, "testHtmlDataScan: parse failed for %s\n",
+                        html);
+                xmlFreeDoc(doc);
+                err = 1;
+                continue;
+            }
+
+            p = body->children;
+            content = xmlGetProp(p, BAD_CAST "title");
+            if ((content == NULL) || (strcmp((char *) content, text) != 0)) {
+                fprintf(stderr, "testHtmlDataScan: wrong attribute for %s\n",
+                        html);
+                err = 1;
+            }
+            xmlFree(content);
+
+            content = xmlNodeGetContent(p);
+            if (strcmp((char *) content, text) != 0) {
+                fprintf(stderr, "testHtmlDataScan: wrong content for %s\n",
+                        html);
+                err = 1;
+            }
+            xmlFree(content);
+
+            /* Comments keep raw references */
+            comment = p->next;
+            content = xmlNodeGetContent(comment);
+            if ((comment == NULL) || (comment->type != XML_COMMENT_NODE) ||
+                (strncmp((char *) content, digits, i) != 0)) {
+                fprintf(stderr, "testHtmlDataScan: wrong comment for %s\n",
+                        html);
+                err = 1;
+            }
+            xmlFree(content);
+
+            expectedLine = (strchr(specials[s], '\n') != NULL) ? 4 : 1;
+            end = xmlGetLastChild(body);
+            if ((end == NULL) || (xmlGetLineNo(end) != expectedLine)) {
+                fprintf(stderr, "testHtmlDataScan: wrong line for %s\n",
+                        html);
+                err = 1;
+            }
+
+            xmlFreeDoc(doc);
+        }
+    }
+
+    return err;
+}
+
+static int
+testHtmlTokenizer(void) {
+    static const char *const tests[] = {
+        "<P Class=a ID='b' hidden data-x=\"&amp;c\" class=d>"
+        "x&lt;y&notit;&frac12</p>",
+        "S(p class=a id=b hidden data-x=&c)T(x<y\xC2\xACit;\xC2\xBD)E(p)",
+
+        "<br/>a\r\nb\r<!DOCTYPE Html SYSTEM 'x'><!-- c -->",
+        "S(br/)T(a\nb\n)D(html)C( c )",
+
+        "<title>a<b>&amp;</title><script>if (a</b) x = '</script';</script>",
+        "S(title)T(a<b>&)E(title)S(script)T(if (a</b) x = '</script';)"
+        "E(script)",
+
+        "<script><!--<script></script>--></script>",
+        "S(script)T(<!--<script></script>-->)E(script)",
+
+        "a < b <!--x--!><!--><?pi?></ y><!x></>z</",
+        "T(a < b )C(x)C()C(?pi?)C( y)C(x)T(z)T(</)",
+
+        "<a b='x\0y'>\0</a><!--a--",
+        "S(a b=x\xEF\xBF\xBDy)E(a)C(a)",
+
+        "<div a=1",
+        "",
+    };
+    const char *input = "<a href=link>";
+    htmlTokenizer *tok;
+    htmlToken token;
+    xmlBufferPtr buf;
+    size_t i;
+    int err = 0;
+    int j;
+
+    buf = xmlBufferCreate();
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i += 2) {
+        /* Inputs can contain NUL bytes */
+        int size = (i == 10) ? 23 : (int) strlen(tests[i]);
+
+        xmlBufferEmpty(buf);
+        tok = htmlNewTokenizer(tests[i], size);
+
+        while (htmlTokenizerNext(tok, &token) > 0) {
+            static const char types[] = "?SETCD";
+
+            xmlBufferAdd(buf, BAD_CAST &types[token.type], 1);
+            xmlBufferCCat(buf, "(");
+            xmlBufferAdd(buf, token.data, token.len);
+            for (j = 0; j < token.nbAttrs; j++) {
+                xmlBufferCCat(buf, " ");
+                xmlBufferAdd(buf, token.attrs[j].name,
+                             token.attrs[j].nameLen);
+                if (token.attrs[j].value != NULL) {
+                    xmlBufferCCat(buf, "=");
+                    xmlBufferAdd(buf, token.attrs[j].value,
+                                 token.attrs[j].valueLen);
+                }
+            }
+            if (token.selfClosing)
+                xmlBufferCCat(buf, "/");
+            xmlBufferCCat(buf, ")");
+        }
+
+        if (strcmp((char *) xmlBufferContent(buf), tests[i+1]) != 0) {
+            fprintf(stderr, "testHtmlTokenizer: got %s, expected %s\n",
+                    xmlBufferContent(buf), tests[i+1]);
+            err = 1;
+        }
+
+        htmlFreeTokenizer(tok);
+    }
+
+    xmlBufferFree(buf);
+
+    /* Unmodified strings point into the input */
+    tok = htmlNewTokenizer(input, strlen(input));
+    if ((htmlTokenizerNext(tok, &token) != 1) ||
+        (token.data != BAD_CAST input + 1) ||
+        (token.nbAttrs != 1) ||
+        (token.attrs[0].value != BAD_CAST input + 8)) {
+        fprintf(stderr, "testHtmlTokenizer: strings were copied\n");
+        err = 1;
+    }
+    htmlFreeTokenizer(tok);
+
+    return err;
+}
+
+static int
+testHtmlIds(void) {
+    const char *htmlContent =
+        "<html><body><div id='myId'>Hello, World!</div></body></html>";
+    htmlDocPtr doc;
+    xmlAttrPtr node;
+
+    doc = htmlReadDoc(BAD_CAST htmlContent, NULL, NULL, 0);
+    if (doc == NULL) {
+        fprintf(stderr, "could not parse HTML content\n");
+        return 1;
+    }
+
+    node = xmlGetID(doc, BAD_CAST "myId");
+    if (node == NULL) {
+        fprintf(stderr, "xmlGetID doesn't work on HTML\n");
+        return 1;
+    }
+
+    xmlFreeDoc(doc);
+    return 0;
+}
+
+static void
+htmlElemOutline(xmlNodePtr node, char *buf, size_t size) {
+    for (; node != NULL; node = node->next) {
+        if (node->type != XML_ELEMENT_NODE)
+            continue;
+        if ((buf[0] != 0) && (buf[strlen(buf) - 1] != '('))
+            strncat(buf, " ", size - strlen(buf) - 1);
+        strncat(buf, (const char *) node->name, size - strlen(buf) - 1);
+        if (node->children != NULL) {
+            size_t len = strlen(buf);
+
+            strncat(buf, "(", size - len - 1);
+            htmlElemOutline(node->children, buf, size);
+            if (strlen(buf) == len + 1)
+                buf[len] = 0;
+            else
+                strncat(buf, ")", size - strlen(buf) - 1);
+        }
+    }
+}
+
+static int
+testHtmlAutoClose(void) {
+    static const struct {
+        const char *input;
+        const char *outline;
+    } tests[] = {
+        { "<TITLE>t</TITLE><P>a<P>b<UL><LI>x<LI>y</UL>",
+          "html(head(title) body(p p ul(li li)))" },
+        { "<p>a<listing>b</listing><dl><dt>c<dd>d<dt>e</dl>",
+          "html(body(p listing dl(dt dd dt)))" },
+        { "<table><tr><td>a<td>b<tr><th>c</table><b>d<p>e",
+          "html(body(table(tr(td td) tr(th)) b p))" },
+        { "<meta charset=utf-8><x-tag>a<p>b</x-tag>",
+          "html(head(meta x-tag(p)))" }
+    };
+    char buf[200];
+    int err = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        htmlDocPtr doc;
+
+        doc = htmlReadDoc(BAD_CAST tests[i].input, NULL, NULL,
+                          HTML_PARSE_NOERROR);
+        buf[0] = 0;
+        if (doc != NULL)
+            htmlElemOutline(doc->children, buf, sizeof(buf));
+        if (strcmp(buf, tests[i].outline) != 0) {
+            fprintf(stderr, "testHtmlAutoClose: %s: got %s, expected %s\n",
+                    tests[i].input, buf, tests[i].outline);
+            err = 1;
+        }
+        xmlFreeDoc(doc);
+    }
+
+    return(err);
+}
+
+#define MHE "meta http-equiv=\"Content-Type\""
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static int
+testHtmlInsertMetaEncoding(void) {
+    /* We currently require a head element to be present. */
+    const char *html =
+        "<html>"
+        "<head></head>"
+        "<body>text</body>"
+        "</html>\n";
+    const char *expect =
+        "<html>"
+        "<head><meta charset=\"utf-8\"></head>"
+        "<body>text</body>"
+        "</html>\n";
+    htmlDocPtr doc;
+    xmlBufferPtr buf;
+    xmlSaveCtxtPtr save;
+    xmlChar *out;
+    int size, err = 0;
+
+
+    doc = htmlReadDoc(BAD_CAST html, NULL, NULL, HTML_PARSE_NODEFDTD);
+
+    /* xmlSave updates meta tags */
+    buf = xmlBufferCreate();
+    save = xmlSaveToBuffer(buf, "utf-8", 0);
+    xmlSaveDoc(save, doc);
+    xmlSaveClose(save);
+    if (!xmlStrEqual(xmlBufferContent(buf), BAD_CAST expect)) {
+        fprintf(stderr, "meta tag insertion failed when serializing\n");
+        err = 1;
+    }
+    xmlBufferFree(buf);
+
+    htmlSetMetaEncoding(doc, BAD_CAST "utf-8");
+    /* htmlDocDumpMemoryFormat doesn't update meta tags */
+    htmlDocDumpMemoryFormat(doc, &out, &size, 0);
+    if (!xmlStrEqual(out, BAD_CAST expect)) {
+        fprintf(stderr, "htmlSetMetaEncoding insertion failed\n");
+        err = 1;
+    }
+    xmlFree(out);
+
+    xmlFreeDoc(doc);
+    return err;
+}
+
+static int
+testHtmlUpdateMetaEncoding(void) {
+    /* We rely on the implementation adjusting all meta tags */
+    const char *html =
+        "<html>\n"
+        "    <head>\n"
+        "        <meta charset=\"utf-8\">\n"
+        "        <meta charset=\"  foo  \">\n"
+        "        <meta charset=\"\">\n"
+        "        <" MHE " content=\"text/html; ChArSeT=foo\">\n"
+        "        <" MHE " content=\"text/html; charset = \">\n"
+        "        <" MHE " content=\"text/html; charset = '  foo  '\">\n"
+        "        <" MHE " content=\"text/html; charset = '  foo  \">\n"
+        "        <" MHE " content='text/html; charset = \"  foo  \"'>\n"
+        "        <" MHE " content='text/html; charset = \"  foo  '>\n"
+        "        <" MHE " content=\"charset ; charset = bar; baz\">\n"
+        "        <" MHE " content=\"text/html\">\n"
+        "        <" MHE " content=\"\">\n"
+        "        <" MHE ">\n"
+        "    </head>\n"
+        "    <body></body>\n"
+        "</html>\n";
+    const char *expect =
+        "<html>\n"
+        "    <head>\n"
+        "        <meta charset=\"utf-8\">\n"
+        "        <meta charset=\"  utf-8  \">\n"
+        "        <meta charset=\"utf-8\">\n"
+        "        <" MHE " content=\"text/html; ChArSeT=utf-8\">\n"
+        "        <" MHE " content=\"text/html; charset = \">\n"
+        "        <" MHE " content=\"text/html; charset = '  utf-8  '\">\n"
+        "        <" MHE " content=\"text/html; charset = '  foo  \">\n"
+        "        <" MHE " content=\"text/html; charset = &quot;  utf-8  &quot;\">\n"
+        "        <" MHE " content=\"text/html; charset = &quot;  foo  \">\n"
+        "        <" MHE " content=\"charset ; charset = utf-8; baz\">\n"
+        "        <" MHE " content=\"text/html\">\n"
+        "        <" MHE " content=\"\">\n"
+        "        <" MHE ">\n"
+        "    </head>\n"
+        "    <body></body>\n"
+        "</html>\n";
+    htmlDocPtr doc;
+    xmlBufferPtr buf;
+    xmlSaveCtxtPtr save;
+    xmlChar *out;
+    int size, err = 0;
+
+    doc = htmlReadDoc(BAD_CAST html, NULL, NULL, HTML_PARSE_NODEFDTD);
+
+    /* xmlSave updates meta tags */
+    buf = xmlBufferCreate();
+    save = xmlSaveToBuffer(buf, NULL, 0);
+    xmlSaveDoc(save, doc);
+    xmlSaveClose(save);
+    if (!xmlStrEqual(xmlBufferContent(buf), BAD_CAST expect)) {
+        fprintf(stderr, "meta tag update failed when serializing\n");
+        err = 1;
+    }
+    xmlBufferFree(buf);
+
+    xmlFree((xmlChar *) doc->encoding);
+    doc->encoding = NULL;
+    htmlSetMetaEncoding(doc, BAD_CAST "utf-8");
+    /* htmlDocDumpMemoryFormat doesn't update meta tags */
+    htmlDocDumpMemoryFormat(doc, &out, &size, 0);
+    if (!xmlStrEqual(out, BAD_CAST expect)) {
+        fprintf(stderr, "htmlSetMetaEncoding update failed\n");
+        err = 1;
+    }
+    xmlFree(out);
+
+    xmlFreeDoc(doc);
+    return err;
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+#ifdef LIBXML_PUSH_ENABLED
+static int
+testHtmlPushWithEncoding(void) {
+    htmlParserCtxtPtr ctxt;
+    htmlDocPtr doc;
+    htmlNodePtr node;
+    int err = 0;
+
+    ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL,
+                                    XML_CHAR_ENCODING_UTF8);
+    htmlParseChunk(ctxt, "-\xC3\xA4-", 4, 1);
+
+    doc = ctxt->myDoc;
+    if (!xmlStrEqual(doc->encoding, BAD_CAST "UTF-8")) {
+        fprintf(stderr, "testHtmlPushWithEncoding failed\n");
+        err = 1;
+    }
+
+    node = xmlDocGetRootElement(doc)->children->children;
+    if (!xmlStrEqual(node->content, BAD_CAST "-\xC3\xA4-")) {
+        fprintf(stderr, "testHtmlPushWithEncoding failed\n");
+        err = 1;
+    }
+
+    xmlFreeDoc(doc);
+    htmlFreeParserCtxt(ctxt);
+    return err;
+}
+#endif
+#endif
+
+#ifdef LIBXML_READER_ENABLED
+static int
+testReaderEncoding(void) {
+    xmlBuffer *buf;
+    xmlTextReader *reader;
+    xmlChar *xml;
+    const xmlChar *encoding;
+    int err = 0;
+    int i;
+
+    buf = xmlBufferCreate();
+    xmlBufferCCat(buf, "<?xml version='1.0' encoding='ISO-8859-1'?>\n");
+    xmlBufferCCat(buf, "<doc>");
+    for (i = 0; i < 8192; i++)
+        xmlBufferCCat(buf, "x");
+    xmlBufferCCat(buf, "</doc>");
+    xml = xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+
+    reader = xmlReaderForDoc(BAD_CAST xml, NULL, NULL, 0);
+    xmlTextReaderRead(reader);
+    encoding = xmlTextReaderConstEncoding(reader);
+
+    if (!xmlStrEqual(encoding, BAD_CAST "ISO-8859-1")) {
+        fprintf(stderr, "testReaderEncoding failed\n");
+        err = 1;
+    }
+
+    xmlFreeTextReader(reader);
+    xmlFree(xml);
+    return err;
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+static int
+testReaderContent(void) {
+    xmlTextReader *reader;
+    const xmlChar *xml = BAD_CAST "<d>x<e>y</e><f>z</f></d>";
+    xmlChar *string;
+    int err = 0;
+
+    reader = xmlReaderForDoc(xml, NULL, NULL, 0);
+    xmlTextReaderRead(reader);
+
+    string = xmlTextReaderReadOuterXml(reader);
+    if (!xmlStrEqual(string, xml)) {
+        fprintf(stderr, "xmlTextReaderReadOuterXml failed\n");
+        err = 1;
+    }
+    xmlFree(string);
+
+    string = xmlTextReaderReadInnerXml(reader);
+    if (!xmlStrEqual(string, BAD_CAST "x<e>y</e><f>z</f>")) {
+        fprintf(stderr, "xmlTextReaderReadInnerXml failed\n");
+        err = 1;
+    }
+    xmlFree(string);
+
+    string = xmlTextReaderReadString(reader);
+    if (!xmlStrEqual(string, BAD_CAST "xyz")) {
+        fprintf(stderr, "xmlTextReaderReadString failed\n");
+        err = 1;
+    }
+    xmlFree(string);
+
+    xmlFreeTextReader(reader);
+    return err;
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+static int
+testReaderNode(xmlTextReader *reader) {
+    xmlChar *string;
+    int type;
+    int err = 0;
+
+    type = xmlTextReaderNodeType(reader);
+    string = xmlTextReaderReadString(reader);
+
+    if (type == XML_READER_TYPE_ELEMENT) {
+        xmlNodePtr node = xmlTextReaderCurrentNode(reader);
+
+        if ((node->children == NULL) != (string == NULL))
+            err = 1;
+    } else if (type == XML_READER_TYPE_TEXT ||
+               type == XML_READER_TYPE_CDATA ||
+               type == XML_READER_TYPE_WHITESPACE ||
+               type == XML_READER_TYPE_SIGNIFICANT_WHITESPACE) {
+        if (string == NULL)
+            err = 1;
+    } else {
+        if (string != NULL)
+            err = 1;
+    }
+
+    if (err)
+        fprintf(stderr, "xmlTextReaderReadString failed for %d\n", type);
+
+    xmlFree(string);
+
+    return err;
+}
+
+static int
+testReader(void) {
+    xmlTextReader *reader;
+    const xmlChar *xml = BAD_CAST
+        "<d>\n"
+        "  x<e a='v'>y</e><f>z</f>\n"
+        "  <![CDATA[cdata]]>\n"
+        "  <!-- comment -->\n"
+        "  <?pi content?>\n"
+        "  <empty/>\n"
+        "</d>";
+    int err = 0;
+
+    reader = xmlReaderForDoc(xml, NULL, NULL, 0);
+
+    while (xmlTextReaderRead(reader) > 0) {
+        if (testReaderNode(reader) > 0) {
+            err = 1;
+            break;
+        }
+
+        if (xmlTextReaderMoveToFirstAttribute(reader) > 0) {
+            do {
+                if (testReaderNode(reader) > 0) {
+                    err = 1;
+                    break;
+                }
+            } while (xmlTextReaderMoveToNextAttribute(reader) > 0);
+
+            xmlTextReaderMoveToElement(reader);
+        }
+    }
+
+    xmlFreeTextReader(reader);
+    return err;
+}
+
+static int
+testReaderFlatTrace(const xmlChar *xml, int flat, xmlChar **trace) {
+    xmlTextReader *reader;
+    xmlChar *str = NULL;
+    char buf[32];
+    int ret;
+
+    reader = xmlReaderForDoc(xml, NULL, NULL, 0);
+    if (((flat == 1) && (xmlTextReaderSetFlat(reader, 1) < 0)) ||
+        ((flat == 2) && (xmlTextReaderSetPipelined(reader, 1) < 0))) {
+        xmlFreeTextReader(reader);
+        return -1;
+    }
+
+    while ((ret = xmlTextReaderRead(reader)) > 0) {
+        snprintf(buf, sizeof(buf), "%d:%d:%d:",
+                 xmlTextReaderNodeType(reader), xmlTextReaderDepth(reader),
+                 xmlTextReaderIsEmptyElement(reader));
+        str = xmlStrcat(str, BAD_CAST buf);
+        str = xmlStrcat(str, xmlTextReaderConstName(reader));
+        str = xmlStrcat(str, BAD_CAST "=");
+        str = xmlStrcat(str, xmlTextReaderConstValue(reader));
+
+        while (xmlTextReaderMoveToNextAttribute(reader) > 0) {
+            str = xmlStrcat(str, BAD_CAST " ");
+            str = xmlStrcat(str, xmlTextReaderConstName(reader));
+            str = xmlStrcat(str, BAD_CAST "{");
+            str = xmlStrcat(str, xmlTextReaderConstNamespaceUri(reader));
+            str = xmlStrcat(str, BAD_CAST "}=");
+            str = xmlStrcat(str, xmlTextReaderConstValue(reader));
+        }
+
+        str = xmlStrcat(str, BAD_CAST "\n");
+    }
+
+    xmlFreeTextReader(reader);
+    *trace = str;
+    return ret;
+}
+
+static int
+testReaderFlat(void) {
+    xmlTextReader *reader;
+    const xmlChar *xml = BAD_CAST
+        "<!DOCTYPE d [<!ENTITY ent 'entity'>]>\n"
+        "<d xmlns='urn:d' xmlns:p='urn:p'>\n"
+        "  x&amp;y<e p:a='v&ent;' b='w'>y</e><f>z</f>\n"
+        "  <![CDATA[cdata]]>&ent;\n"
+        "  <!-- comment -->\n"
+        "  <?pi content?>\n"
+        "  <p:empty/><g><h/></g>\n"
+        "</d>";
+    xmlChar *tree = NULL, *flat = NULL;
+    int err = 0;
+
+    if ((testReaderFlatTrace(xml, 0, &tree) < 0) ||
+        (testReaderFlatTrace(xml, 1, &flat) < 0) ||
+        (!xmlStrEqual(tree, flat))) {
+        fprintf(stderr, "xmlTextReaderSetFlat events differ\n");
+        err = 1;
+    }
+    xmlFree(tree);
+    xmlFree(flat);
+
+    reader = xmlReaderForDoc(xml, NULL, NULL, 0);
+    xmlTextReaderSetFlat(reader, 1);
+    while (xmlTextReaderRead(reader) > 0) {
+        const xmlChar *name = xmlTextReaderConstLocalName(reader);
+
+        if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+            continue;
+
+#ifdef LIBXML_OUTPUT_ENABLED
+        if (xmlStrEqual(name, BAD_CAST "e")) {
+            xmlChar *string = xmlTextReaderReadOuterXml(reader);
+
+            if (!xmlStrEqual(string,
+                    BAD_CAST "<e xmlns=\"urn:d\" xmlns:p=\"urn:p\" "
+                             "p:a=\"ventity\" b=\"w\">y</e>")) {
+                fprintf(stderr, "xmlTextReaderReadOuterXml failed in "
+                        "flat mode: %s\n", (char *) string);
+                err = 1;
+            }
+            xmlFree(string);
+        }
+#endif
+
+        if (xmlStrEqual(name, BAD_CAST "g")) {
+            if ((xmlTextReaderNext(reader) <= 0) ||
+                (xmlTextReaderNodeType(reader) !=
+                 XML_READER_TYPE_SIGNIFICANT_WHITESPACE &&
+                 xmlTextReaderNodeType(reader) !=
+                 XML_READER_TYPE_WHITESPACE) ||
+                (xmlTextReaderDepth(reader) != 1)) {
+                fprintf(stderr, "xmlTextReaderNext failed in flat mode\n");
+                err = 1;
+            }
+        }
+    }
+    xmlFreeTextReader(reader);
+
+    return err;
+}
+
+static int
+testReaderNextSkip(void) {
+    static const char *const expected[] = {
+        "5:ent 1:k 15:d ",
+        "1:x 3:#text 15:x 1:k 15:d "
+    };
+    xmlBuffer *buf;
+    int err = 0;
+    int i, j;
+
+    /* Make the skipped subtree span many chunks */
+    buf = xmlBufferCreate();
+    xmlBufferCat(buf, BAD_CAST
+        "<!DOCTYPE d [<!ENTITY ent '<x>e</x>'>]>\n"
+        "<d><s>");
+    for (i = 0; i < 1000; i++)
+        xmlBufferCat(buf, BAD_CAST "<e a='&amp;'>text<f/><!--c--></e>");
+    xmlBufferCat(buf, BAD_CAST "&ent;</s>&ent;<k/></d>");
+
+    for (i = 0; i < 4; i++) {
+        xmlTextReader *reader;
+        xmlChar *trace = NULL;
+        char num[16];
+
+        reader = xmlReaderForDoc(xmlBufferContent(buf), NULL, NULL,
+                                 (i & 1) ? XML_PARSE_NOENT : 0);
+        if ((i & 2) && (xmlTextReaderSetFlat(reader, 1) < 0)) {
+            fprintf(stderr, "xmlTextReaderSetFlat failed\n");
+            err = 1;
+        }
+
+        for (j = 0; j < 3; j++)
+            xmlTextReaderRead(reader);
+        if (!xmlStrEqual(xmlTextReaderConstName(reader), BAD_CAST "s")) {
+            fprintf(stderr, "Unexpected node %s\n",
+                    (char *) xmlTextReaderConstName(reader));
+            err = 1;
+        }
+
+        if (xmlTextReaderNext(reader) == 1) {
+            do {
+                snprintf(num, sizeof(num), "%d:",
+                         xmlTextReaderNodeType(reader));
+                trace = xmlStrcat(trace, BAD_CAST num);
+                trace = xmlStrcat(trace, xmlTextReaderConstName(reader));
+                trace = xmlStrcat(trace, BAD_CAST " ");
+            } while (xmlTextReaderRead(reader) == 1);
+        }
+
+        if (!xmlStrEqual(trace, BAD_CAST expected[i & 1])) {
+            fprintf(stderr, "xmlTextReaderNext failed (mode %d): %s\n",
+                    i, (char *) trace);
+            err = 1;
+        }
+
+        xmlFree(trace);
+        xmlFreeTextReader(reader);
+    }
+
+    xmlBufferFree(buf);
+    return err;
+}
+
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_OUTPUT_ENABLED)
+static int
+testReaderPreservePrune(void) {
+    const char *modes[] = {
+        "xmlPatternMatch", "pattern set", "pruning", "xmlTextReaderNext"
+    };
+    xmlChar *dumps[4] = { NULL, NULL, NULL, NULL };
+    int counts[4] = { 0, 0, 0, 0 };
+    xmlBuffer *buf;
+    int err = 0;
+    int i;
+
+    buf = xmlBufferCreate();
+    xmlBufferCat(buf, BAD_CAST "<doc><recs>");
+    for (i = 0; i < 200; i++)
+        xmlBufferCat(buf, BAD_CAST
+            "<rec><keep>k<i/></keep><junk a='1'>j<keep/><x>y</x></junk>"
+            "</rec>");
+    xmlBufferCat(buf, BAD_CAST
+        "</recs><other><rec><keep/></rec></other></doc>");
+
+    for (i = 0; i < 4; i++) {
+        xmlTextReader *reader;
+        xmlDoc *doc;
+        int ret, size;
+
+        reader = xmlReaderForDoc(xmlBufferContent(buf), NULL, NULL, 0);
+        xmlTextReaderPreservePattern(reader, BAD_CAST "/doc/recs/rec/keep",
+                                     NULL);
+        /* Attribute patterns disable matching while parsing */
+        if (i == 0)
+            xmlTextReaderPreservePattern(reader, BAD_CAST "none/@none", NULL);
+        if ((i == 2) && (xmlTextReaderSetPreservePrune(reader, 1) < 0)) {
+            fprintf(stderr, "xmlTextReaderSetPreservePrune failed\n");
+            err = 1;
+        }
+
+        ret = xmlTextReaderRead(reader);
+        while (ret == 1) {
+            counts[i]++;
+            if ((i == 3) &&
+                (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT) &&
+                (xmlStrEqual(xmlTextReaderConstName(reader),
+                             BAD_CAST "junk")))
+                ret = xmlTextReaderNext(reader);
+            else
+                ret = xmlTextReaderRead(reader);
+        }
+        if (ret != 0) {
+            fprintf(stderr, "testReaderPreservePrune: %s: read failed\n",
+                    modes[i]);
+            err = 1;
+        }
+
+        doc = xmlTextReaderCurrentDoc(reader);
+        xmlDocDumpMemory(doc, &dumps[i], &size);
+        xmlFreeDoc(doc);
+        xmlFreeTextReader(reader);
+
+        if ((i > 0) && (!xmlStrEqual(dumps[i], dumps[0]))) {
+            fprintf(stderr, "testReaderPreservePrune: %s: got %s\n",
+                    modes[i], (char *) dumps[i]);
+            err = 1;
+        }
+    }
+
+    if ((counts[1] != counts[0]) || (counts[2] >= counts[1])) {
+        fprintf(stderr, "testReaderPreservePrune: unexpected counts "
+                "%d %d %d\n", counts[0], counts[1], counts[2]);
+        err = 1;
+    }
+
+    for (i = 0; i < 4; i++)
+        xmlFree(dumps[i]);
+    xmlBufferFree(buf);
+    return err;
+}
+#endif /* LIBXML_PATTERN_ENABLED && LIBXML_OUTPUT_ENABLED */
+
+static int
+testReaderGetAttributes(void) {
+    const xmlChar *xml = BAD_CAST
+        "<!DOCTYPE d [<!ENTITY ent 'entity'>]>\n"
+        "<d xmlns='urn:d' xmlns:p='urn:p' a='1'>"
+        "<e p:a='v&ent;w' b='' c='x&amp;y' d='&ent;'/>"
+        "<f/>"
+        "</d>";
+    int err = 0;
+    int flat;
+
+    for (flat = 0; flat < 2; flat++) {
+        xmlTextReader *reader;
+        const xmlTextReaderAttr *attrs;
+        int nb, i;
+
+        reader = xmlReaderForDoc(xml, NULL, NULL, 0);
+        if (flat)
+            xmlTextReaderSetFlat(reader, 1);
+
+        while (xmlTextReaderRead(reader) > 0) {
+            nb = xmlTextReaderGetAttributes(reader, &attrs);
+            if (nb != xmlTextReaderAttributeCount(reader)) {
+                fprintf(stderr, "xmlTextReaderGetAttributes returned %d "
+                        "attributes\n", nb);
+                err = 1;
+                break;
+            }
+
+            for (i = 0; i < nb; i++) {
+                const xmlTextReaderAttr *attr = &attrs[i];
+
+                xmlTextReaderMoveToAttributeNo(reader, i);
+                if ((!xmlStrEqual(attr->localname,
+                                  xmlTextReaderConstLocalName(reader))) ||
+                    (!xmlStrEqual(attr->prefix,
+                                  xmlTextReaderConstPrefix(reader))) ||
+                    (!xmlStrEqual(attr->URI,
+                                  xmlTextReaderConstNamespaceUri(reader))) ||
+                    (!xmlStrEqual(attr->value,
+                                  xmlTextReaderConstValue(reader))) ||
+                    (attr->len != xmlStrlen(attr->value))) {
+                    fprintf(stderr, "xmlTextReaderGetAttributes failed "
+                            "(flat %d): %s=%s\n", flat,
+                            (char *) attr->localname, (char *) attr->value);
+                    err = 1;
+                }
+            }
+            xmlTextReaderMoveToElement(reader);
+        }
+
+        xmlFreeTextReader(reader);
+    }
+
+    return err;
+}
+
+static int
+testReaderPipelined(void) {
+    xmlTextReader *reader;
+    xmlBuffer *buf;
+    xmlChar *tree = NULL, *pipelined = NULL;
+    char num[64];
+    int err = 0;
+    int i, count = 0;
+
+    reader = xmlReaderForDoc(BAD_CAST "<d/>", NULL, NULL, 0);
+    if (xmlTextReaderSetPipelined(reader, 1) < 0) {
+        /* No thread support */
+        xmlFreeTextReader(reader);
+        return 0;
+    }
+    xmlFreeTextReader(reader);
+
+    /* Make the document span many batches */
+    buf = xmlBufferCreate();
+    xmlBufferCat(buf, BAD_CAST
+        "<!DOCTYPE d [<!ENTITY ent 'entity'>]>\n"
+        "<d xmlns:p='urn:p'>");
+    for (i = 0; i < 2000; i++) {
+        snprintf(num, sizeof(num), "<e p:a='&ent;' n='%d'>", i);
+        xmlBufferCat(buf, BAD_CAST num);
+        xmlBufferCat(buf, BAD_CAST
+            "x&amp;y<f/><!--c--><?pi x?><![CDATA[cd]]></e>\n");
+    }
+    xmlBufferCat(buf, BAD_CAST "</d>");
+
+    if ((testReaderFlatTrace(xmlBufferContent(buf), 0, &tree) < 0) ||
+        (testReaderFlatTrace(xmlBufferContent(buf), 2, &pipelined) < 0) ||
+        (!xmlStrEqual(tree, pipelined))) {
+        fprintf(stderr, "xmlTextReaderSetPipelined events differ\n");
+        err = 1;
+    }
+    xmlFree(tree);
+    xmlFree(pipelined);
+
+    reader = xmlReaderForDoc(xmlBufferContent(buf), NULL, NULL, 0);
+    xmlTextReaderSetPipelined(reader, 1);
+    while (xmlTextReaderRead(reader) > 0) {
+        xmlChar *n;
+
+        if ((xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) ||
+            (!xmlStrEqual(xmlTextReaderConstName(reader), BAD_CAST "e")))
+            continue;
+
+        count++;
+        n = xmlTextReaderGetAttribute(reader, BAD_CAST "n");
+#ifdef LIBXML_OUTPUT_ENABLED
+        if (xmlStrEqual(n, BAD_CAST "1000")) {
+            xmlChar *string = xmlTextReaderReadOuterXml(reader);
+
+            if (!xmlStrEqual(string,
+                    BAD_CAST "<e xmlns:p=\"urn:p\" p:a=\"entity\" "
+                             "n=\"1000\">x&amp;y<f/><!--c--><?pi x?>"
+                             "<![CDATA[cd]]></e>")) {
+                fprintf(stderr, "xmlTextReaderReadOuterXml failed in "
+                        "pipelined mode: %s\n", (char *) string);
+                err = 1;
+            }
+            xmlFree(string);
+        }
+#endif
+        if (xmlStrEqual(n, BAD_CAST "1500")) {
+            if ((xmlTextReaderNext(reader) <= 0) ||
+                (xmlTextReaderNodeType(reader) !=
+                 XML_READER_TYPE_SIGNIFICANT_WHITESPACE &&
+                 xmlTextReaderNodeType(reader) !=
+                 XML_READER_TYPE_WHITESPACE) ||
+                (xmlTextReaderDepth(reader) != 1)) {
+                fprintf(stderr, "xmlTextReaderNext failed in pipelined "
+                        "mode\n");
+                err = 1;
+            }
+        }
+        xmlFree(n);
+    }
+    if ((count != 2000) ||
+        (xmlTextReaderReadState(reader) != XML_TEXTREADER_MODE_EOF)) {
+        fprintf(stderr, "xmlTextReaderRead failed in pipelined mode\n");
+        err = 1;
+    }
+    xmlFreeTextReader(reader);
+
+    /* Free the reader while the parser thread is running */
+    reader = xmlReaderForDoc(xmlBufferContent(buf), NULL, NULL, 0);
+    xmlTextReaderSetPipelined(reader, 1);
+    xmlTextReaderRead(reader);
+    xmlFreeTextReader(reader);
+
+    xmlBufferFree(buf);
+    return err;
+}
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+static void
+testReaderSchemaReuseError(void *arg, const xmlError *error ATTRIBUTE_UNUSED) {
+    int *count = arg;
+
+    *count += 1;
+}
+
+static int
+testReaderSchemaReuse(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:element name='msg'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='id' type='xs:int'/>\n"
+        "        <xs:element name='body' type='xs:string'/>\n"
+        "      </xs:sequence>\n"
+        "    </xs:complexType>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    static const char *const docs[] = {
+        "<msg><id>1</id><body>a</body></msg>",
+        "<msg><id>x</id><body>a</body></msg>",
+        "<msg><id>2</id><body>b</body></msg>",
+        /* Only partially read */
+        "<msg><id>3</id><id>4</id></msg>",
+        "<msg><id>5</id><body>c</body></msg>"
+    };
+    static const int valid[] = { 1, 0, 1, -1, 1 };
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema;
+    xmlTextReader *reader;
+    int errors = 0;
+    int err = 0;
+    int i, j;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    schema = xmlSchemaParse(pctxt);
+    xmlSchemaFreeParserCtxt(pctxt);
+    if (schema == NULL) {
+        fprintf(stderr, "testReaderSchemaReuse: parsing schema failed\n");
+        return(1);
+    }
+
+    reader = xmlReaderForMemory(docs[0], strlen(docs[0]), NULL, NULL, 0);
+    xmlTextReaderSetStructuredErrorHandler(reader,
+                                           testReaderSchemaReuseError,
+                                           &errors);
+    if (xmlTextReaderSetSchema(reader, schema) != 0) {
+        fprintf(stderr, "testReaderSchemaReuse: enabling validation "
+                "failed\n");
+        err = 1;
+    }
+
+    for (i = 0; i < 5; i++) {
+        if ((i > 0) &&
+            (xmlReaderNewMemory(reader, docs[i], strlen(docs[i]), NULL,
+                                NULL, 0) != 0)) {
+            fprintf(stderr, "testReaderSchemaReuse: xmlReaderNewMemory "
+                    "failed\n");
+            err = 1;
+            break;
+        }
+
+        errors = 0;
+        if (valid[i] < 0) {
+            for (j = 0; j < 3; j++)
+                xmlTextReaderRead(reader);
+            continue;
+        }
+        while (xmlTextReaderRead(reader) > 0)
+            ;
+        if ((xmlTextReaderIsValid(reader) != valid[i]) ||
+            ((errors == 0) != valid[i])) {
+            fprintf(stderr, "testReaderSchemaReuse: document %d: valid %d, "
+                    "%d errors\n", i, xmlTextReaderIsValid(reader), errors);
+            err = 1;
+        }
+    }
+
+    xmlFreeTextReader(reader);
+    xmlSchemaFree(schema);
+    return(err);
+}
+#endif /* LIBXML_SCHEMAS_ENABLED */
+
+#ifdef LIBXML_C14N_ENABLED
+static int
+testReaderC14NSubtree(void) {
+    const char *xml =
+        "<root xmlns='urn:d' xmlns:a='urn:a' xmlns:b='urn:b' xml:lang='en'>"
+        "<!--c--><x:skip xmlns:x='urn:x'>s</x:skip>"
+        "<mid xml:space='preserve'>"
+        "<a:target b:attr='1' a:z='2'>"
+        "<inner xmlns=''>t &amp; <![CDATA[<c>]]></inner>"
+        "<!--in--><?pi d?><b:e/>"
+        "</a:target>"
+        "</mid><after/></root>";
+    const xmlChar *expr = BAD_CAST
+        "(//. | //@* | //namespace::*)[ancestor-or-self::a:target]";
+    static const xmlChar *const prefixes[] = { BAD_CAST "b", NULL };
+    xmlDocPtr doc;
+    xmlXPathContextPtr xpctxt;
+    xmlXPathObjectPtr xpobj;
+    int err = 0;
+    int mode, comments;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    xpctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(xpctxt, BAD_CAST "a", BAD_CAST "urn:a");
+    xpobj = xmlXPathEvalExpression(expr, xpctxt);
+    if ((xpobj == NULL) || (xpobj->nodesetval == NULL)) {
+        fprintf(stderr, "testReaderC14NSubtree: XPath failed\n");
+        err = 1;
+        goto done;
+    }
+
+    for (mode = XML_C14N_1_0; mode <= XML_C14N_1_1; mode++) {
+        for (comments = 0; comments <= 1; comments++) {
+            xmlTextReaderPtr reader;
+            xmlOutputBufferPtr out;
+            xmlChar *expected = NULL;
+            int size, ret;
+
+            size = xmlC14NDocDumpMemory(doc, xpobj->nodesetval, mode,
+                                        (xmlChar **) prefixes, comments,
+                                        &expected);
+
+            reader = xmlReaderForDoc(BAD_CAST xml, NULL, NULL, 0);
+            out = xmlAllocOutputBuffer(NULL);
+            while ((xmlTextReaderRead(reader) == 1) &&
+                   (!xmlStrEqual(xmlTextReaderConstLocalName(reader),
+                                 BAD_CAST "target")))
+                ;
+            ret = xmlC14NReaderSaveTo(reader, mode, (xmlChar **) prefixes,
+                                      comments, out);
+
+            if ((size < 0) || (ret < 0) ||
+                (xmlOutputBufferGetSize(out) != (size_t) size) ||
+                (memcmp(xmlOutputBufferGetContent(out), expected,
+                        size) != 0)) {
+                fprintf(stderr, "testReaderC14NSubtree: mode %d, comments "
+                        "%d: got\n%s\nexpected\n%s\n", mode, comments,
+                        xmlOutputBufferGetContent(out), expected);
+                err = 1;
+            }
+
+            /* The reader is left on the end of the subtree */
+            if ((xmlTextReaderNodeType(reader) !=
+                 XML_READER_TYPE_END_ELEMENT) ||
+                (!xmlStrEqual(xmlTextReaderConstLocalName(reader),
+                              BAD_CAST "target"))) {
+                fprintf(stderr, "testReaderC14NSubtree: reader not on "
+                        "end of subtree\n");
+                err = 1;
+            }
+            while (xmlTextReaderRead(reader) == 1)
+                ;
+            if (xmlTextReaderReadState(reader) != XML_TEXTREADER_MODE_EOF) {
+                fprintf(stderr, "testReaderC14NSubtree: reading after "
+                        "subtree failed\n");
+                err = 1;
+            }
+
+            xmlOutputBufferClose(out);
+            xmlFreeTextReader(reader);
+            xmlFree(expected);
+        }
+    }
+
+done:
+    xmlXPathFreeObject(xpobj);
+    xmlXPathFreeContext(xpctxt);
+    xmlFreeDoc(doc);
+    return(err);
+}
+#endif /* LIBXML_C14N_ENABLED */
+
+#ifdef LIBXML_XINCLUDE_ENABLED
+typedef struct {
+    char *message;
+    int code;
+} testReaderErrorCtxt;
+
+static void
+testReaderError(void *arg, const char *msg,
+                xmlParserSeverities severity ATTRIBUTE_UNUSED,
+                xmlTextReaderLocatorPtr locator ATTRIBUTE_UNUSED) {
+    testReaderErrorCtxt *ctxt = arg;
+
+    if (ctxt->message != NULL)
+        xmlFree(ctxt->message);
+    ctxt->message = xmlMemStrdup(msg);
+}
+
+static void
+testStructuredReaderError(void *arg, const xmlError *error) {
+    testReaderErrorCtxt *ctxt = arg;
+
+    if (ctxt->message != NULL)
+        xmlFree(ctxt->message);
+    ctxt->message = xmlMemStrdup(error->message);
+    ctxt->code = error->code;
+}
+
+static int
+testReaderXIncludeError(void) {
+    /*
+     * Test whether XInclude errors are reported to the custom error
+     * handler of a reader.
+     */
+    const char *doc =
+        "<doc xmlns:xi='http://www.w3.org/2001/XInclude'>\n"
+        "  <xi:include/>\n"
+        "</doc>\n";
+    xmlTextReader *reader;
+    testReaderErrorCtxt errorCtxt;
+    int err = 0;
+
+    reader = xmlReaderForDoc(BAD_CAST doc, NULL, NULL, XML_PARSE_XINCLUDE);
+    xmlTextReaderSetErrorHandler(reader, testReaderError, &errorCtxt);
+    errorCtxt.message = NULL;
+    errorCtxt.code = 0;
+    while (xmlTextReaderRead(reader) > 0)
+        ;
+
+    if (errorCtxt.message == NULL ||
+        strstr(errorCtxt.message, "href or xpointer") == NULL) {
+        fprintf(stderr, "xmlTextReaderSetErrorHandler failed\n");
+        err = 1;
+    }
+
+    xmlFree(errorCtxt.message);
+    xmlFreeTextReader(reader);
+
+    reader = xmlReaderForDoc(BAD_CAST doc, NULL, NULL, XML_PARSE_XINCLUDE);
+    xmlTextReaderSetStructuredErrorHandler(reader, testStructuredReaderError,
+                                           &errorCtxt);
+    errorCtxt.message = NULL;
+    errorCtxt.code = 0;
+    while (xmlTextReaderRead(reader) > 0)
+        ;
+
+    if (errorCtxt.code != XML_XINCLUDE_NO_HREF ||
+        errorCtxt.message == NULL ||
+        strstr(errorCtxt.message, "href or xpointer") == NULL) {
+        fprintf(stderr, "xmlTextReaderSetStructuredErrorHandler failed\n");
+        err = 1;
+    }
+
+    xmlFree(errorCtxt.message);
+    xmlFreeTextReader(reader);
+
+    return err;
+}
+#endif
+#endif
+
+#ifdef LIBXML_WRITER_ENABLED
+static int
+testWriterIOWrite(void *ctxt, const char *data, int len) {
+    (void) ctxt;
+    (void) data;
+
+    return len;
+}
+
+static int
+testWriterIOClose(void *ctxt) {
+    (void) ctxt;
+
+    return XML_IO_ENAMETOOLONG;
+}
+
+static int
+testWriterClose(void){
+    xmlOutputBufferPtr out;
+    xmlTextWriterPtr writer;
+    int err = 0;
+    int result;
+
+    out = xmlOutputBufferCreateIO(testWriterIOWrite, testWriterIOClose,
+                                  NULL, NULL);
+    writer = xmlNewTextWriter(out);
+    xmlTextWriterStartDocument(writer, "1.0", "UTF-8", NULL);
+    xmlTextWriterStartElement(writer, BAD_CAST "elem");
+    xmlTextWriterEndElement(writer);
+    xmlTextWriterEndDocument(writer);
+    result = xmlTextWriterClose(writer);
+
+    if (result != XML_IO_ENAMETOOLONG) {
+        fprintf(stderr, "xmlTextWriterClose reported wrong error %d\n",
+                result);
+        err = 1;
+    }
+
+    xmlFreeTextWriter(writer);
+    return err;
+}
+
+static int
+testWriterTrustedRun(int trusted, const char *encoding, xmlChar **out) {
+    static const char *const names[] = { "e0", "e1", "e2", "e3" };
+    xmlBufferPtr buf;
+    xmlTextWriterPtr writer;
+    char name[16];
+    int i;
+
+    buf = xmlBufferCreate();
+    writer = xmlNewTextWriterMemory(buf, 0);
+    xmlTextWriterSetTrusted(writer, trusted);
+    xmlTextWriterStartDocument(writer, "1.0", encoding, NULL);
+    xmlTextWriterStartElementNS(writer, BAD_CAST "p", BAD_CAST "doc",
+                                BAD_CAST "urn:p");
+
+    /* Deep enough to grow the element stack */
+    for (i = 0; i < 40; i++) {
+        if (trusted) {
+            xmlTextWriterStartElement(writer, BAD_CAST names[i % 4]);
+        } else {
+            /* Overwrite the name to detect missing copies */
+            snprintf(name, sizeof(name), "%s", names[i % 4]);
+            xmlTextWriterStartElement(writer, BAD_CAST name);
+            memset(name, 'x', sizeof(name) - 1);
+            name[sizeof(name) - 1] = 0;
+        }
+        xmlTextWriterWriteAttribute(writer, BAD_CAST "a",
+                                    BAD_CAST "\"<&>\"\r");
+        if (i % 3 == 0)
+            xmlTextWriterWriteString(writer,
+                    BAD_CAST "text <with> \"special\" & chars\r\xC3\xA9");
+    }
+    for (i = 0; i < 40; i++)
+        xmlTextWriterEndElement(writer);
+
+    xmlTextWriterStartElement(writer, BAD_CAST "static");
+    xmlTextWriterWriteString(writer, BAD_CAST "a&b");
+    xmlTextWriterEndDocument(writer);
+    xmlFreeTextWriter(writer);
+
+    *out = xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+    return(0);
+}
+
+static int
+testWriterTrusted(void) {
+    static const char *const encodings[] = { NULL, "ISO-8859-1" };
+    xmlChar *plain, *trusted;
+    int err = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i++) {
+        const char *enc = encodings[i];
+        const char *expected = (enc == NULL) ?
+            "text &lt;with&gt; &quot;special&quot; &amp; chars&#13;\xC3\xA9" :
+            "text &lt;with&gt; &quot;special&quot; &amp; chars&#13;\xE9";
+
+        testWriterTrustedRun(0, enc, &plain);
+        testWriterTrustedRun(1, enc, &trusted);
+
+        if ((plain == NULL) ||
+            (strstr((char *) plain,
+                    "<e3 a=\"&quot;&lt;&amp;&gt;&quot;&#13;\">") == NULL) ||
+            (strstr((char *) plain, "</e3></e2></e1></e0>") == NULL) ||
+            (strstr((char *) plain, expected) == NULL) ||
+            (strstr((char *) plain, "<static>a&amp;b</static>") == NULL) ||
+            (strstr((char *) plain, "<p:doc xmlns:p=\"urn:p\">") == NULL)) {
+            fprintf(stderr, "Unexpected writer output:\n%s\n",
+                    plain ? (char *) plain : "(null)");
+            err = 1;
+        } else if ((trusted == NULL) ||
+                   (strcmp((char *) plain, (char *) trusted) != 0)) {
+            fprintf(stderr, "Trusted writer output differs\n");
+            err = 1;
+        }
+
+        xmlFree(plain);
+        xmlFree(trusted);
+    }
+
+    return err;
+}
+
+static xmlChar *
+testWriterElementsRun(int batch, int indent) {
+    static const xmlChar *const attrs[] = {
+        BAD_CAST "id", BAD_CAST "1", BAD_CAST "q", BAD_CAST "\"<&>\"",
+        NULL
+    };
+    static const xmlTextWriterElement elems[] = {
+        { BAD_CAST "a", attrs, BAD_CAST "x < y & \"z\"" },
+        { BAD_CAST "b", NULL, NULL },
+        { BAD_CAST "c", attrs, NULL },
+        { BAD_CAST "d", NULL, BAD_CAST "" }
+    };
+    xmlBufferPtr buf;
+    xmlTextWriterPtr writer;
+    xmlChar *ret;
+    int i, j;
+
+    buf = xmlBufferCreate();
+    writer = xmlNewTextWriterMemory(buf, 0);
+    xmlTextWriterSetIndent(writer, indent);
+    xmlTextWriterStartDocument(writer, NULL, NULL, NULL);
+    xmlTextWriterStartElementNS(writer, BAD_CAST "p", BAD_CAST "doc",
+                                BAD_CAST "urn:p");
+    xmlTextWriterStartAttribute(writer, BAD_CAST "open");
+
+    for (i = 0; i < 3; i++) {
+        if (batch) {
+            if (xmlTextWriterWriteElements(writer, elems, 4) < 0)
+                break;
+            continue;
+        }
+
+        for (j = 0; j < 4; j++) {
+            const xmlTextWriterElement *elem = &elems[j];
+            int k;
+
+            xmlTextWriterStartElement(writer, elem->name);
+            for (k = 0; elem->attrs && elem->attrs[k]; k += 2)
+                xmlTextWriterWriteAttribute(writer, elem->attrs[k],
+                                            elem->attrs[k+1]);
+            if (elem->text)
+                xmlTextWriterWriteString(writer, elem->text);
+            xmlTextWriterEndElement(writer);
+        }
+    }
+
+    xmlTextWriterEndDocument(writer);
+    xmlFreeTextWriter(writer);
+
+    ret = xmlBufferDetach(buf);
+    xmlBufferFree(buf);
+    return(ret);
+}
+
+static int
+testWriterElements(void) {
+    static const xmlTextWriterElement bad[] = {
+        { BAD_CAST "ok", NULL, NULL },
+        { BAD_CAST "", NULL, NULL }
+    };
+    xmlTextWriterPtr writer;
+    xmlBufferPtr buf;
+    int err = 0;
+    int indent;
+
+    for (indent = 0; indent < 2; indent++) {
+        xmlChar *calls = testWriterElementsRun(0, indent);
+        xmlChar *batch = testWriterElementsRun(1, indent);
+
+        if ((calls == NULL) || (batch == NULL) ||
+            (strcmp((char *) calls, (char *) batch) != 0)) {
+            fprintf(stderr, "xmlTextWriterWriteElements mismatch:\n%s\n%s\n",
+                    calls ? (char *) calls : "(null)",
+                    batch ? (char *) batch : "(null)");
+            err = 1;
+        }
+
+        xmlFree(calls);
+        xmlFree(batch);
+    }
+
+    /* Invalid batches are rejected without output */
+    buf = xmlBufferCreate();
+    writer = xmlNewTextWriterMemory(buf, 0);
+    if ((xmlTextWriterWriteElements(writer, bad, 2) != -1) ||
+        (xmlTextWriterFlush(writer) < 0) ||
+        (xmlBufferLength(buf) != 0)) {
+        fprintf(stderr, "xmlTextWriterWriteElements accepted empty name\n");
+        err = 1;
+    }
+    xmlFreeTextWriter(writer);
+    xmlBufferFree(buf);
+
+    return err;
+}
+#endif
+
+typedef struct {
+    const char *uri;
+    const char *base;
+    const char *result;
+} xmlRelativeUriTest;
+
+static int
+testBuildRelativeUri(void) {
+    xmlChar *res;
+    int err = 0;
+    int i;
+
+    static const xmlRelativeUriTest tests[] = {
+        {
+            "/a/b1/c1",
+            "/a/b2/c2",
+            "../b1/c1"
+        }, {
+            "a/b1/c1",
+            "a/b2/c2",
+            "../b1/c1"
+        }, {
+            "a/././b1/x/y/../z/../.././c1",
+            "./a/./b2/././b2",
+            "../b1/c1"
+        }, {
+            "file:///a/b1/c1",
+            "/a/b2/c2",
+            NULL
+        }, {
+            "/a/b1/c1",
+            "file:///a/b2/c2",
+            NULL
+        }, {
+            "a/b1/c1",
+            "/a/b2/c2",
+            NULL
+        }, {
+            "/a/b1/c1",
+            "a/b2/c2",
+            NULL
+        }, {
+            "http://example.org/a/b1/c1",
+            "http://example.org/a/b2/c2",
+            "../b1/c1"
+        }, {
+            "http://example.org/a/b1/c1",
+            "https://example.org/a/b2/c2",
+            NULL
+        }, {
+            "http://example.org/a/b1/c1",
+            "http://localhost/a/b2/c2",
+            NULL
+        }, {
+            "with space/x x/y y",
+            "with space/b2/c2",
+            "../x%20x/y%20y"
+        }, {
+            "with space/x x/y y",
+            "/b2/c2",
+            "with%20space/x%20x/y%20y"
+        }
+#if defined(_WIN32) || defined(__CYGWIN__)
+        , {
+            "\\a\\b1\\c1",
+            "\\a\\b2\\c2",
+            "../b1/c1"
+        }, {
+            "\\a\\b1\\c1",
+            "/a/b2/c2",
+            "../b1/c1"
+        }, {
+            "a\\b1\\c1",
+            "a/b2/c2",
+            "../b1/c1"
+        }, {
+            "file://server/a/b1/c1",
+            "\\\\?\\UNC\\server\\a\\b2\\c2",
+            "../b1/c1"
+        }, {
+            "file://server/a/b1/c1",
+            "\\\\server\\a\\b2\\c2",
+            "../b1/c1"
+        }, {
+            "file:///x:/a/b1/c1",
+            "x:\\a\\b2\\c2",
+            "../b1/c1"
+        }, {
+            "file:///x:/a/b1/c1",
+            "\\\\?\\x:\\a\\b2\\c2",
+            "../b1/c1"
+        }, {
+            "file:///x:/a/b1/c1",
+            "file:///y:/a/b2/c2",
+            NULL
+        }, {
+            "x:/a/b1/c1",
+            "y:/a/b2/c2",
+            "file:///x:/a/b1/c1"
+        }, {
+            "/a/b1/c1",
+            "y:/a/b2/c2",
+            NULL
+        }, {
+            "\\\\server\\a\\b1\\c1",
+            "a/b2/c2",
+            "file://server/a/b1/c1"
+        }
+#endif
+    };
+
+    for (i = 0; (size_t) i < sizeof(tests) / sizeof(tests[0]); i++) {
+        const xmlRelativeUriTest *test = tests + i;
+        const char *expect;
+
+        res = xmlBuildRelativeURI(BAD_CAST test->uri, BAD_CAST test->base);
+        expect = test->result ? test->result : test->uri;
+        if (!xmlStrEqual(res, BAD_CAST expect)) {
+            fprintf(stderr, "xmlBuildRelativeURI failed uri=%s base=%s "
+                    "result=%s expected=%s\n", test->uri, test->base,
+                    res, expect);
+            err = 1;
+        }
+        xmlFree(res);
+    }
+
+    return err;
+}
+
+/*
+ * The first cases take the resolver fast path, the others must be
+ * handed to the generic code.
+ */
+static int
+testBuildUri(void) {
+    xmlChar *res;
+    int err = 0;
+    int i;
+
+    static const xmlRelativeUriTest tests[] = {
+        {
+            "b.xml",
+            "http://example.com/a/doc.xml",
+            "http://example.com/a/b.xml"
+        }, {
+            "../b.xml",
+            "http://example.com/a/doc.xml?q#f",
+            "http://example.com/b.xml"
+        }, {
+            "/b/./c.xml",
+            "http://example.com:8080/a/doc.xml",
+            "http://example.com:8080/b/./c.xml"
+        }, {
+            "b.xml",
+            "http://example.com",
+            "http://example.com/b.xml"
+        }, {
+            "./b.xml",
+            "file:///a/b/doc.xml",
+            "file:///a/b/b.xml"
+        }, {
+            "../../b.xml",
+            "dir/sub/doc.xml",
+            "b.xml"
+        }, {
+            "sub/../b.xml",
+            "/dir/./doc.xml",
+            "/dir/b.xml"
+        }, {
+            "/b.xml",
+            "dir/doc.xml",
+            "/b.xml"
+        }, {
+            "b.xml",
+            "",
+            "b.xml"
+        }, {
+            "b.xml",
+            "http://example.com/a:b/doc.xml",
+            "http://example.com/a%3Ab/b.xml"
+        }, {
+            "b%20c.xml",
+            "http://example.com/a/doc.xml",
+            "http://example.com/a/b%20c.xml"
+        }, {
+            "b.xml?q",
+            "http://example.com/a/doc.xml",
+            "http://example.com/a/b.xml?q"
+        }
+    };
+
+    for (i = 0; (size_t) i < sizeof(tests) / sizeof(tests[0]); i++) {
+        const xmlRelativeUriTest *test = tests + i;
+
+        res = xmlBuildURI(BAD_CAST test->uri, BAD_CAST test->base);
+        if (res == NULL || !xmlStrEqual(res, BAD_CAST test->result)) {
+            fprintf(stderr, "xmlBuildURI failed uri=%s base=%s "
+                    "result=%s expected=%s\n", test->uri, test->base,
+                    res, test->result);
+            err = 1;
+        }
+        xmlFree(res);
+    }
+
+    return err;
+}
+
+#if defined(_WIN32) || defined(__CYGWIN__)
+static int
+testWindowsUri(void) {
+    const char *url = "c:/a%20b/file.txt";
+    xmlURIPtr uri;
+    xmlChar *res;
+    int err = 0;
+    int i;
+
+    static const xmlRelativeUriTest tests[] = {
+        {
+            "c:/a%20b/file.txt",
+            "base.xml",
+            "c:/a b/file.txt"
+        }, {
+            "file:///c:/a%20b/file.txt",
+            "base.xml",
+            "file:///c:/a%20b/file.txt"
+        }, {
+            "Z:/a%20b/file.txt",
+            "http://example.com/",
+            "Z:/a b/file.txt"
+        }, {
+            "a%20b/b1/c1",
+            "C:/a/b2/c2",
+            "C:/a/b2/a b/b1/c1"
+        }, {
+            "a%20b/b1/c1",
+            "\\a\\b2\\c2",
+            "/a/b2/a b/b1/c1"
+        }, {
+            "a%20b/b1/c1",
+            "\\\\?\\a\\b2\\c2",
+            "//?/a/b2/a b/b1/c1"
+        }, {
+            "a%20b/b1/c1",
+            "\\\\\\\\server\\b2\\c2",
+            "//server/b2/a b/b1/c1"
+        }
+    };
+
+    uri = xmlParseURI(url);
+    if (uri == NULL) {
+        fprintf(stderr, "xmlParseURI failed\n");
+        err = 1;
+    } else {
+        if (uri->scheme != NULL) {
+            fprintf(stderr, "invalid scheme: %s\n", uri->scheme);
+            err = 1;
+        }
+        if (uri->path == NULL || strcmp(uri->path, "c:/a b/file.txt") != 0) {
+            fprintf(stderr, "invalid path: %s\n", uri->path);
+            err = 1;
+        }
+
+        xmlFreeURI(uri);
+    }
+
+    for (i = 0; (size_t) i < sizeof(tests) / sizeof(tests[0]); i++) {
+        const xmlRelativeUriTest *test = tests + i;
+
+        res = xmlBuildURI(BAD_CAST test->uri, BAD_CAST test->base);
+        if (res == NULL || !xmlStrEqual(res, BAD_CAST test->result)) {
+            fprintf(stderr, "xmlBuildURI failed uri=%s base=%s "
+                    "result=%s expected=%s\n", test->uri, test->base,
+                    res, test->result);
+            err = 1;
+        }
+        xmlFree(res);
+    }
+
+    return err;
+}
+#endif /* WIN32 */
+
+#if defined(LIBXML_ICONV_ENABLED) || defined(LIBXML_ICU_ENABLED)
+static int
+testTruncatedMultiByte(void) {
+    const char xml[] =
+        "<?xml version=\"1.0\" encoding=\"EUC-JP\"?>\n"
+        "<doc/>\xC3";
+#ifdef LIBXML_HTML_ENABLED
+    const char html[] =
+        "<meta charset=\"EUC-JP\">\n"
+        "<div/>\xC3";
+#endif
+    xmlDocPtr doc;
+    const xmlError *error;
+    int err = 0;
+
+    xmlResetLastError();
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, XML_PARSE_NOERROR);
+    error = xmlGetLastError();
+    if (error == NULL || error->code != XML_ERR_INVALID_ENCODING) {
+        fprintf(stderr, "xml, pull: expected XML_ERR_INVALID_ENCODING\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+
+#ifdef LIBXML_HTML_ENABLED
+    xmlResetLastError();
+    doc = htmlReadDoc(BAD_CAST html, NULL, NULL, XML_PARSE_NOERROR);
+    error = xmlGetLastError();
+    if (error == NULL || error->code != XML_ERR_INVALID_ENCODING) {
+        fprintf(stderr, "html, pull: expected XML_ERR_INVALID_ENCODING\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+#endif /* LIBXML_HTML_ENABLED */
+
+#ifdef LIBXML_PUSH_ENABLED
+    {
+        xmlParserCtxtPtr ctxt;
+
+        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
+        xmlCtxtSetOptions(ctxt, XML_PARSE_NOERROR);
+
+        xmlParseChunk(ctxt, xml, sizeof(xml) - 1, 0);
+        xmlParseChunk(ctxt, "", 0, 1);
+
+        if (ctxt->errNo != XML_ERR_INVALID_ENCODING) {
+            fprintf(stderr, "xml, push: expected XML_ERR_INVALID_ENCODING\n");
+            err = 1;
+        }
+
+        xmlFreeDoc(ctxt->myDoc);
+        xmlFreeParserCtxt(ctxt);
+
+#ifdef LIBXML_HTML_ENABLED
+        ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL,
+                                        XML_CHAR_ENCODING_NONE);
+        xmlCtxtSetOptions(ctxt, XML_PARSE_NOERROR);
+
+        htmlParseChunk(ctxt, html, sizeof(html) - 1, 0);
+        htmlParseChunk(ctxt, "", 0, 1);
+
+        if (ctxt->errNo != XML_ERR_INVALID_ENCODING) {
+            fprintf(stderr, "html, push: expected XML_ERR_INVALID_ENCODING\n");
+            err = 1;
+        }
+
+        xmlFreeDoc(ctxt->myDoc);
+        htmlFreeParserCtxt(ctxt);
+#endif /* LIBXML_HTML_ENABLED */
+    }
+#endif /* LIBXML_PUSH_ENABLED */
+
+    return err;
+}
+
+/*
+ * Converters are pooled and reused. A converter left in a shifted
+ * state must be reset before the next document sees it.
+ */
+static int
+testPooledConverter(void) {
+    const char shifted[] =
+        "<?xml version=\"1.0\" encoding=\"ISO-2022-JP\"?>\n"
+        "<doc>\x1B$B\x30\x21\x1B(B</doc>\x1B$B";
+    const char plain[] =
+        "<?xml version=\"1.0\" encoding=\"ISO-2022-JP\"?>\n"
+        "<doc>abc</doc>";
+    xmlCharEncodingHandler *handler;
+    int i;
+    int err = 0;
+
+    if (xmlCreateCharEncodingHandler("ISO-2022-JP", XML_ENC_INPUT,
+                                     NULL, NULL, &handler) != XML_ERR_OK)
+        return 0;
+    xmlCharEncCloseFunc(handler);
+
+    for (i = 0; i < 3; i++) {
+        xmlDocPtr doc;
+        xmlChar *content;
+
+        doc = xmlReadDoc(BAD_CAST shifted, NULL, NULL,
+                         XML_PARSE_NOERROR | XML_PARSE_RECOVER);
+        xmlFreeDoc(doc);
+
+        doc = xmlReadDoc(BAD_CAST plain, NULL, NULL, XML_PARSE_NOERROR);
+        content = xmlNodeGetContent((xmlNodePtr) doc);
+        if ((content == NULL) || (strcmp((char *) content, "abc") != 0)) {
+            fprintf(stderr, "testPooledConverter: converter not reset\n");
+            err = 1;
+        }
+        xmlFree(content);
+        xmlFreeDoc(doc);
+    }
+
+    return err;
+}
+#endif /* iconv || icu */
+
+static int charEncConvImplError;
+
+static xmlCharEncError
+rot13Convert(void *vctxt, unsigned char *out, int *outlen,
+             const unsigned char *in, int *inlen,
+             int flush ATTRIBUTE_UNUSED) {
+    int *ctxt = vctxt;
+    int inSize = *inlen;
+    int outSize = *outlen;
+    int rot, i;
+
+    rot = *ctxt;
+
+    for (i = 0; i < inSize && i < outSize; i++) {
+        int c = in[i];
+
+        if (c >= 'A' && c <= 'Z')
+            c = 'A' + (c - 'A' + rot) % 26;
+        else if (c >= 'a' && c <= 'z')
+            c = 'a' + (c - 'a' + rot) % 26;
+
+        out[i] = c;
+    }
+
+    *inlen = i;
+    *outlen = i;
+
+    return XML_ENC_ERR_SUCCESS;
+}
+
+static void
+rot13ConvCtxtDtor(void *vctxt) {
+    xmlFree(vctxt);
+}
+
+static xmlParserErrors
+rot13ConvImpl(void *vctxt ATTRIBUTE_UNUSED, const char *name,
+              xmlCharEncFlags flags, xmlCharEncodingHandler **out) {
+    int *inputCtxt;
+
+    if (strcmp(name, "rot13") != 0)
+        return xmlCreateCharEncodingHandler(name, flags, NULL, NULL, out);
+
+    if (flags & XML_ENC_OUTPUT)
+        return XML_ERR_UNSUPPORTED_ENCODING;
+
+    inputCtxt = xmlMalloc(sizeof(*inputCtxt));
+    *inputCtxt = 13;
+
+    return xmlCharEncNewCustomHandler(name, rot13Convert, NULL,
+                                      rot13ConvCtxtDtor, inputCtxt, NULL,
+                                      out);
+}
+
+static int
+testCharEncConvImpl(void) {
+    xmlParserCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    int err = 0;
+
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetCharEncConvImpl(ctxt, rot13ConvImpl, NULL);
+    charEncConvImplError = 0;
+    doc = xmlCtxtReadDoc(ctxt, BAD_CAST "<?kzy irefvba='1.0'?><qbp/>", NULL,
+                         "rot13", 0);
+    if (charEncConvImplError)
+        err = 1;
+    xmlFreeParserCtxt(ctxt);
+
+    root = xmlDocGetRootElement(doc);
+    if (root == NULL || strcmp((char *) root->name, "doc") != 0) {
+        fprintf(stderr, "testCharEncConvImpl failed\n");
+        err = 1;
+    }
+
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+#ifdef LIBXML_XPATH_ENABLED
+static void
+exprCacheOne(xmlXPathParserContextPtr ctxt, int nargs ATTRIBUTE_UNUSED) {
+    xmlXPathValuePush(ctxt, xmlXPathNewFloat(1));
+}
+
+static void
+exprCacheTwo(xmlXPathParserContextPtr ctxt, int nargs ATTRIBUTE_UNUSED) {
+    xmlXPathValuePush(ctxt, xmlXPathNewFloat(2));
+}
+
+/* Evaluates other expressions while the calling one is in use */
+static void
+exprCacheNested(xmlXPathParserContextPtr ctxt, int nargs ATTRIBUTE_UNUSED) {
+    xmlXPathObjectPtr res;
+    double sum = 0;
+
+    /* Flushes the cache including the calling expression */
+    xmlXPathRegisterNs(ctxt->context, BAD_CAST "q", BAD_CAST "urn:q");
+
+    res = xmlXPathEval(BAD_CAST "count(//e)", ctxt->context);
+    if (res != NULL)
+        sum += res->floatval;
+    xmlXPathFreeObject(res);
+    res = xmlXPathEval(BAD_CAST "count(/doc)", ctxt->context);
+    if (res != NULL)
+        sum += res->floatval;
+    xmlXPathFreeObject(res);
+
+    xmlXPathValuePush(ctxt, xmlXPathNewFloat(sum));
+}
+
+static double
+exprCacheEval(xmlXPathContextPtr ctxt, const char *expr) {
+    xmlXPathObjectPtr res;
+    double val = -1;
+
+    res = xmlXPathEval(BAD_CAST expr, ctxt);
+    if ((res != NULL) && (res->type == XPATH_NUMBER))
+        val = res->floatval;
+    xmlXPathFreeObject(res);
+
+    return(val);
+}
+
+static int
+testXPathExprCache(void) {
+    static const char *const exprs[] = {
+        "count(//e)", "count(/doc)", "count(//e[2])", "count(//e)"
+    };
+    static const double values[] = { 3, 1, 1, 3 };
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    int i, j;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST "<doc><e/><e/><e/></doc>", NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathSetErrorHandler(ctxt, ignoreError, NULL);
+    xmlXPathContextSetExprCache(ctxt, 2);
+
+    for (j = 0; j < 3; j++) {
+        for (i = 0; i < 4; i++) {
+            if (exprCacheEval(ctxt, exprs[i]) != values[i]) {
+                fprintf(stderr, "testXPathExprCache: wrong result for %s\n",
+                        exprs[i]);
+                err = 1;
+            }
+        }
+    }
+
+    /* Compilation errors are reported every time */
+    for (i = 0; i < 2; i++) {
+        if ((xmlXPathEval(BAD_CAST "count(", ctxt) != NULL) ||
+            (ctxt->lastError.code == XML_ERR_OK)) {
+            fprintf(stderr, "testXPathExprCache: error not reported\n");
+            err = 1;
+        }
+    }
+
+    /* Registering namespaces and functions flushes the cache */
+    xmlXPathRegisterNs(ctxt, BAD_CAST "p", BAD_CAST "urn:a");
+    xmlXPathRegisterFuncNS(ctxt, BAD_CAST "f", BAD_CAST "urn:a",
+                           exprCacheOne);
+    xmlXPathRegisterFuncNS(ctxt, BAD_CAST "f", BAD_CAST "urn:b",
+                           exprCacheTwo);
+    if (exprCacheEval(ctxt, "p:f()") != 1) {
+        fprintf(stderr, "testXPathExprCache: wrong function result\n");
+        err = 1;
+    }
+    xmlXPathRegisterNs(ctxt, BAD_CAST "p", BAD_CAST "urn:b");
+    if (exprCacheEval(ctxt, "p:f()") != 2) {
+        fprintf(stderr, "testXPathExprCache: stale namespace binding\n");
+        err = 1;
+    }
+
+    /* Nested evaluations can flush the entry in use */
+    xmlXPathContextSetExprCache(ctxt, 1);
+    xmlXPathRegisterFunc(ctxt, BAD_CAST "nested", exprCacheNested);
+    for (i = 0; i < 2; i++) {
+        if (exprCacheEval(ctxt, "nested()") != 4) {
+            fprintf(stderr, "testXPathExprCache: nested evaluation failed\n");
+            err = 1;
+        }
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+static int
+testXPathOptimizer(void) {
+    static const char *const exprs[] = {
+        "count(//a[@x = concat($p, 'x')])",
+        "count(//a[@x = concat(/doc/c/@y, 'x')])",
+        "count(//a) > 0",
+        "count(//z) > 0",
+        "0 < count(//b)",
+        "count(//a/b) != 0",
+        "count(//z) >= 1",
+        "string(//a[position() = last()]/@x)",
+        "string(/doc/*[last()]/@y)",
+        "count(//a[last()][2])",
+        "count(/doc/namespace::*[last()])",
+        "1 + 2 * 3",
+        "concat('a', substring('xyz', 2))"
+    };
+    static const char *const values[] = {
+        "2", "2", "true", "false", "true", "true", "false",
+        "1x", "1", "0", "1", "7", "ayz"
+    };
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr res;
+    xmlChar *str;
+    size_t i;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST
+                     "<doc xmlns:p='urn:p'><a x='1x'/><a x='2'/>"
+                     "<a x='1x'><b/></a><c y='1'/></doc>",
+                     NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterVariable(ctxt, BAD_CAST "p",
+                             xmlXPathNewString(BAD_CAST "1"));
+
+    for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+        res = xmlXPathEval(BAD_CAST exprs[i], ctxt);
+        str = res ? xmlXPathCastToString(res) : NULL;
+        if ((str == NULL) || (strcmp((char *) str, values[i]) != 0)) {
+            fprintf(stderr, "testXPathOptimizer: %s returned %s\n",
+                    exprs[i], str ? (char *) str : "NULL");
+            err = 1;
+        }
+        xmlFree(str);
+        xmlXPathFreeObject(res);
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+static int
+keyLookupIds(xmlXPathObjectPtr res, const char *expected) {
+    char ids[16];
+    int i, len = 0;
+
+    if ((res == NULL) || (res->type != XPATH_NODESET))
+        return(1);
+    for (i = 0; (res->nodesetval != NULL) &&
+                (i < res->nodesetval->nodeNr) && (len < 15); i++) {
+        xmlChar *id = xmlGetProp(res->nodesetval->nodeTab[i],
+                                 BAD_CAST "id");
+
+        ids[len++] = id ? id[0] : '?';
+        xmlFree(id);
+    }
+    ids[len] = 0;
+
+    return(strcmp(ids, expected) != 0);
+}
+
+static int
+testXPathKeys(void) {
+    static const char *const exprs[] = {
+        "index-lookup('cat', 'x')",
+        "index-lookup('cat', //ref/@to)",
+        "index-lookup('tok', 'x')",
+        "index-lookup('tok', 'b')",
+        "index-lookup('cat', 'z')",
+        "//ref[count(index-lookup('cat', @to)) = 1]/../item[2]"
+    };
+    static const char *const ids[] = { "ac", "abc", "ac", "b", "", "b" };
+    xmlDocPtr doc, doc2;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr res;
+    xmlNodePtr item;
+    size_t i;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST
+                     "<doc><item id='a' cat='x'/><item id='b' cat='y'/>"
+                     "<item id='c' cat='x'/><ref to='x'/><ref to='y'/></doc>",
+                     NULL, NULL, 0);
+    doc2 = xmlReadDoc(BAD_CAST "<doc><item id='d' cat='x'/></doc>",
+                      NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathSetErrorHandler(ctxt, ignoreError, NULL);
+
+    if ((xmlXPathRegisterKey(ctxt, BAD_CAST "cat", BAD_CAST "//item",
+                             BAD_CAST "@cat") != 0) ||
+        (xmlXPathRegisterKey(ctxt, BAD_CAST "tok", BAD_CAST "//item",
+                             BAD_CAST "@id | @cat") != 0) ||
+        (xmlXPathRegisterKey(ctxt, BAD_CAST "bad", BAD_CAST "//item[",
+                             BAD_CAST "@id") == 0)) {
+        fprintf(stderr, "testXPathKeys: registering keys failed\n");
+        err = 1;
+    }
+
+    for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+        res = xmlXPathEval(BAD_CAST exprs[i], ctxt);
+        if (keyLookupIds(res, ids[i])) {
+            fprintf(stderr, "testXPathKeys: wrong result for %s\n",
+                    exprs[i]);
+            err = 1;
+        }
+        xmlXPathFreeObject(res);
+    }
+
+    res = xmlXPathEval(BAD_CAST "index-lookup('bad', 'x')", ctxt);
+    if (res != NULL) {
+        fprintf(stderr, "testXPathKeys: unknown key accepted\n");
+        err = 1;
+    }
+    xmlXPathFreeObject(res);
+
+    /* Indexes are built per document */
+    res = xmlXPathKeyLookup(ctxt, doc2, BAD_CAST "cat", BAD_CAST "x");
+    if (keyLookupIds(res, "d")) {
+        fprintf(stderr, "testXPathKeys: wrong result for second document\n");
+        err = 1;
+    }
+    xmlXPathFreeObject(res);
+
+    /* Modified documents must be reindexed */
+    item = xmlNewChild(xmlDocGetRootElement(doc), NULL, BAD_CAST "item",
+                       NULL);
+    xmlSetProp(item, BAD_CAST "id", BAD_CAST "e");
+    xmlSetProp(item, BAD_CAST "cat", BAD_CAST "x");
+    xmlXPathClearKeyIndexes(ctxt);
+    res = xmlXPathKeyLookup(ctxt, doc, BAD_CAST "cat", BAD_CAST "x");
+    if (keyLookupIds(res, "ace")) {
+        fprintf(stderr, "testXPathKeys: index not rebuilt\n");
+        err = 1;
+    }
+    xmlXPathFreeObject(res);
+
+    xmlXPathRegisterKey(ctxt, BAD_CAST "cat", NULL, NULL);
+    if (xmlXPathKeyLookup(ctxt, doc, BAD_CAST "cat", BAD_CAST "x") != NULL) {
+        fprintf(stderr, "testXPathKeys: key not unregistered\n");
+        err = 1;
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc2);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+static void
+nameIndexIds(xmlXPathContextPtr ctxt, const char *expr, char *out,
+             size_t size) {
+    xmlXPathObjectPtr res;
+    size_t len = 0;
+    int i;
+
+    out[0] = 0;
+    res = xmlXPathEval(BAD_CAST expr, ctxt);
+    if (res == NULL) {
+        snprintf(out, size, "error");
+        return;
+    }
+    if (res->type == XPATH_NUMBER) {
+        snprintf(out, size, "%g", res->floatval);
+    } else if (res->type == XPATH_BOOLEAN) {
+        snprintf(out, size, "%d", res->boolval);
+    } else if ((res->type == XPATH_NODESET) && (res->nodesetval != NULL)) {
+        for (i = 0; i < res->nodesetval->nodeNr; i++) {
+            xmlChar *id = xmlGetProp(res->nodesetval->nodeTab[i],
+                                     BAD_CAST "id");
+
+            snprintf(out + len, size - len, "%s,",
+                     id ? (char *) id : "?");
+            len += strlen(out + len);
+            xmlFree(id);
+        }
+    }
+    xmlXPathFreeObject(res);
+}
+
+static int
+testNameIndex(void) {
+    static const char *const exprs[] = {
+        "//b", "//a//b", "//b[2]", "//x:b", "//a/b", "//b[@id='6']",
+        "//*", "//missing", "count(//b)", "boolean(//x:c)",
+        "//a[1]/descendant-or-self::a", "//c/descendant::b",
+        "(//a)[last()]//b", "/doc//a[b]"
+    };
+    static const char xml[] =
+        "<doc id='0' xmlns:y='urn:x'>"
+          "<a id='1'><b id='2'/><c id='3'><b id='4'/></c></a>"
+          "<a id='5'><a id='6'><b id='7'/></a><y:b id='8'/></a>"
+          "<b id='9'/><y:c id='10'/>"
+        "</doc>";
+    char plain[200], indexed[200];
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    xmlNodePtr node;
+    size_t i;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "x", BAD_CAST "urn:x");
+
+    for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+        xmlDocSetNameIndex(doc, 0);
+        nameIndexIds(ctxt, exprs[i], plain, sizeof(plain));
+        xmlDocSetNameIndex(doc, 1);
+        nameIndexIds(ctxt, exprs[i], indexed, sizeof(indexed));
+        if (strcmp(plain, indexed) != 0) {
+            fprintf(stderr, "testNameIndex: %s: expected %s, got %s\n",
+                    exprs[i], plain, indexed);
+            err = 1;
+        }
+    }
+
+    /* Tree modifications invalidate the index */
+    nameIndexIds(ctxt, "//b", indexed, sizeof(indexed));
+    node = xmlNewChild(xmlDocGetRootElement(doc), NULL, BAD_CAST "b", NULL);
+    xmlSetProp(node, BAD_CAST "id", BAD_CAST "11");
+    nameIndexIds(ctxt, "//b", indexed, sizeof(indexed));
+    if (strcmp(indexed, "2,4,7,9,11,") != 0) {
+        fprintf(stderr, "testNameIndex: added node not found: %s\n",
+                indexed);
+        err = 1;
+    }
+
+    node = xmlDocGetRootElement(doc)->children;
+    xmlUnlinkNode(node);
+    xmlFreeNode(node);
+    xmlNodeSetName(xmlDocGetRootElement(doc)->last, BAD_CAST "d");
+    nameIndexIds(ctxt, "//b", indexed, sizeof(indexed));
+    if (strcmp(indexed, "7,9,") != 0) {
+        fprintf(stderr, "testNameIndex: removed node found: %s\n",
+                indexed);
+        err = 1;
+    }
+
+    xmlNodeSetContent(xmlDocGetRootElement(doc)->children, BAD_CAST "text");
+    nameIndexIds(ctxt, "//b", indexed, sizeof(indexed));
+    if (strcmp(indexed, "9,") != 0) {
+        fprintf(stderr, "testNameIndex: replaced content found: %s\n",
+                indexed);
+        err = 1;
+    }
+
+    /* Unlinked subtrees aren't indexed */
+    node = xmlDocGetRootElement(doc)->children;
+    xmlUnlinkNode(node);
+    xmlAddChild(node, xmlNewDocNode(doc, NULL, BAD_CAST "b", NULL));
+    xmlXPathSetContextNode(node, ctxt);
+    nameIndexIds(ctxt, "count(.//b)", indexed, sizeof(indexed));
+    if (strcmp(indexed, "1") != 0) {
+        fprintf(stderr, "testNameIndex: unlinked subtree: %s\n", indexed);
+        err = 1;
+    }
+    xmlFreeNode(node);
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+static int
+testValueIndex(void) {
+    static const char *const exprs[] = {
+        "//b[@k='1']", "//b[@k=$v]", "//b['2'=@k]", "//b[@x:k='1']",
+        "/doc/b[@k='1']", "//a/b[@k='1']", "//a[@k='1']//b[@k='1']",
+        "//b[@k='3']", "//b[@k=$n]", "//b[@k=$missing]", "//b[@k='']",
+        "count(//b[@k='1'])", "//b[@k='1'][2]", "//b[@k='1'][@id>3]",
+        "//*[@k='1']", "//b[@k!='1']"
+    };
+    static const char xml[] =
+        "<doc xmlns:y='urn:x'>"
+          "<a k='1'><b id='1' k='1'/><b id='2' k='2'/>"
+            "<c><b id='3' k='1' y:k='1'/></c></a>"
+          "<b id='4' k='1'/><b id='5' y:k='2'/><b id='6' k=''/>"
+        "</doc>";
+    char plain[200], indexed[200];
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    xmlNodePtr node;
+    size_t i;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "x", BAD_CAST "urn:x");
+    xmlXPathSetErrorHandler(ctxt, ignoreError, NULL);
+    xmlXPathRegisterVariable(ctxt, BAD_CAST "v",
+                             xmlXPathNewCString("2"));
+    xmlXPathRegisterVariable(ctxt, BAD_CAST "n", xmlXPathNewFloat(1));
+
+    for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+        xmlDocSetNameIndex(doc, 0);
+        nameIndexIds(ctxt, exprs[i], plain, sizeof(plain));
+        xmlDocSetNameIndex(doc, 1);
+        nameIndexIds(ctxt, exprs[i], indexed, sizeof(indexed));
+        if (strcmp(plain, indexed) != 0) {
+            fprintf(stderr, "testValueIndex: %s: expected %s, got %s\n",
+                    exprs[i], plain, indexed);
+            err = 1;
+        }
+    }
+
+    /* Attribute changes invalidate the value tables */
+    nameIndexIds(ctxt, "//b[@k='1']", indexed, sizeof(indexed));
+    node = xmlDocGetRootElement(doc)->last;
+    xmlSetProp(node, BAD_CAST "k", BAD_CAST "1");
+    xmlSetProp(xmlDocGetRootElement(doc)->children->children,
+               BAD_CAST "k", BAD_CAST "0");
+    xmlNodeSetContent((xmlNodePtr) xmlHasProp(node->prev, BAD_CAST "id"),
+                      BAD_CAST "7");
+    xmlNewProp(node->prev, BAD_CAST "k", BAD_CAST "1");
+    nameIndexIds(ctxt, "//b[@k='1']", indexed, sizeof(indexed));
+    if (strcmp(indexed, "3,4,7,6,") != 0) {
+        fprintf(stderr, "testValueIndex: changed attributes: %s\n",
+                indexed);
+        err = 1;
+    }
+
+    xmlRemoveProp(xmlHasProp(node, BAD_CAST "k"));
+    xmlNodeSetContent(xmlHasNsProp(node->prev, BAD_CAST "k", NULL)->children,
+                      BAD_CAST "2");
+    nameIndexIds(ctxt, "//b[@k='1']", indexed, sizeof(indexed));
+    if (strcmp(indexed, "3,4,") != 0) {
+        fprintf(stderr, "testValueIndex: removed attributes: %s\n",
+                indexed);
+        err = 1;
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+static int
+orderIndexCompare(xmlXPathContextPtr ctxt, const char *expr) {
+    xmlXPathObjectPtr plain, indexed;
+    int i, err = 0;
+
+    xmlDocSetNameIndex(ctxt->doc, 0);
+    plain = xmlXPathEval(BAD_CAST expr, ctxt);
+    xmlDocSetNameIndex(ctxt->doc, 1);
+    indexed = xmlXPathEval(BAD_CAST expr, ctxt);
+
+    if ((plain == NULL) || (indexed == NULL) ||
+        (plain->nodesetval == NULL) || (indexed->nodesetval == NULL) ||
+        (plain->nodesetval->nodeNr != indexed->nodesetval->nodeNr)) {
+        err = 1;
+    } else {
+        for (i = 0; i < plain->nodesetval->nodeNr; i++) {
+            if (plain->nodesetval->nodeTab[i] !=
+                indexed->nodesetval->nodeTab[i])
+                err = 1;
+        }
+    }
+    if (err)
+        fprintf(stderr, "testOrderIndex: %s: node-sets differ\n", expr);
+
+    xmlXPathFreeObject(plain);
+    xmlXPathFreeObject(indexed);
+    return(err);
+}
+
+static int
+testOrderIndex(void) {
+    static const char *const exprs[] = {
+        "//c | //b", "//@n | //text() | //comment()",
+        "//b/text() | //a | /", "//*[@n='1'] | //*[@n='2']",
+        "(//c | //b)/.. | //processing-instruction()"
+    };
+    xmlDocPtr doc;
+    xmlNodePtr root, a, b, node;
+    xmlXPathContextPtr ctxt;
+    char num[20];
+    size_t j;
+    int i, err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 100; i++) {
+        snprintf(num, sizeof(num), "%d", i % 3);
+        a = xmlNewChild(root, NULL, BAD_CAST "a", NULL);
+        xmlNewProp(a, BAD_CAST "n", BAD_CAST num);
+        b = xmlNewChild(a, NULL, BAD_CAST "b", BAD_CAST "text");
+        xmlNewProp(b, BAD_CAST "n", BAD_CAST num);
+        xmlAddChild(a, xmlNewDocComment(doc, BAD_CAST "comment"));
+        xmlNewChild(i % 2 ? b : a, NULL, BAD_CAST "c", NULL);
+        xmlAddChild(a, xmlNewDocText(doc, BAD_CAST "tail"));
+    }
+
+    ctxt = xmlXPathNewContext(doc);
+
+    for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+        err |= orderIndexCompare(ctxt, exprs[j]);
+
+    /* Adding and removing non-element nodes discards the table */
+    node = xmlNewDocPI(doc, BAD_CAST "pi", NULL);
+    xmlAddPrevSibling(root->children->next->children, node);
+    node = root->last->children;
+    xmlUnlinkNode(node);
+    xmlFreeNode(node);
+    xmlNodeSetContent(root->children, NULL);
+    xmlNewProp(root->last, BAD_CAST "n", BAD_CAST "9");
+    for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+        err |= orderIndexCompare(ctxt, exprs[j]);
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+testNodeSetMergeHash(void) {
+    static const char *const exprs[] = {
+        "count(//a | //b | //a)",
+        "count(//a/namespace::* | //namespace::*)",
+        "count(//b/namespace::* | //a/namespace::*)",
+        "count((//a | //b)[self::b] | //b/..)"
+    };
+    static const double values[] = { 200, 401, 400, 200 };
+    xmlDocPtr doc;
+    xmlNodePtr root, a;
+    xmlXPathContextPtr ctxt;
+    int err = 0;
+    int i;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 100; i++) {
+        a = xmlNewChild(root, NULL, BAD_CAST "a", NULL);
+        xmlNewNs(a, BAD_CAST "urn:p", BAD_CAST "p");
+        xmlNewChild(a, NULL, BAD_CAST "b", NULL);
+    }
+
+    ctxt = xmlXPathNewContext(doc);
+    for (i = 0; i < (int) (sizeof(exprs) / sizeof(exprs[0])); i++) {
+        xmlXPathObjectPtr res = xmlXPathEval(BAD_CAST exprs[i], ctxt);
+
+        if ((res == NULL) || (res->type != XPATH_NUMBER) ||
+            (res->floatval != values[i])) {
+            fprintf(stderr, "testNodeSetMergeHash: %s: %f\n", exprs[i],
+                    res ? res->floatval : -1);
+            err = 1;
+        }
+        xmlXPathFreeObject(res);
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return err;
+}
+
+static int
+testNodeSetInline(void) {
+    xmlNodePtr nodes[20];
+    xmlNodeSetPtr set;
+    xmlDocPtr doc;
+    xmlNodePtr root;
+    int err = 0;
+    int i;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 20; i++)
+        nodes[i] = xmlNewChild(root, NULL, BAD_CAST "a", NULL);
+
+    /* Grow from the inline nodes to the heap */
+    set = xmlXPathNodeSetCreate(nodes[0]);
+    for (i = 1; i < 20; i++)
+        xmlXPathNodeSetAdd(set, nodes[i]);
+    for (i = 0; i < 20; i++) {
+        if ((set->nodeNr != 20) || (set->nodeTab[i] != nodes[i])) {
+            fprintf(stderr, "testNodeSetInline: wrong node %d\n", i);
+            err = 1;
+            break;
+        }
+    }
+    xmlXPathFreeNodeSet(set);
+
+    set = xmlXPathNodeSetCreate(NULL);
+    xmlXPathNodeSetAdd(set, nodes[1]);
+    xmlXPathNodeSetAddNs(set, root, xmlSearchNs(doc, root, BAD_CAST "xml"));
+    if ((set->nodeNr != 2) ||
+        (!xmlXPathNodeSetContains(set, nodes[1]))) {
+        fprintf(stderr, "testNodeSetInline: inline set broken\n");
+        err = 1;
+    }
+    xmlXPathFreeNodeSet(set);
+
+    xmlFreeDoc(doc);
+    return err;
+}
+
+static int
+childIndexCompare(xmlXPathContextPtr ctxt, const char *expr) {
+    xmlXPathObjectPtr plain, indexed;
+    int i, err = 0;
+
+    /* Evaluate with the current index first to detect stale tables */
+    indexed = xmlXPathEval(BAD_CAST expr, ctxt);
+    xmlDocSetNameIndex(ctxt->doc, 0);
+    plain = xmlXPathEval(BAD_CAST expr, ctxt);
+    xmlDocSetNameIndex(ctxt->doc, 1);
+
+    if ((plain == NULL) || (indexed == NULL) ||
+        (plain->nodesetval == NULL) || (indexed->nodesetval == NULL) ||
+        (plain->nodesetval->nodeNr != indexed->nodesetval->nodeNr)) {
+        err = 1;
+    } else {
+        for (i = 0; i < plain->nodesetval->nodeNr; i++) {
+            if (plain->nodesetval->nodeTab[i] !=
+                indexed->nodesetval->nodeTab[i])
+                err = 1;
+        }
+    }
+    if (err)
+        fprintf(stderr, "testChildIndex: %s: node-sets differ\n", expr);
+
+    xmlXPathFreeObject(plain);
+    xmlXPathFreeObject(indexed);
+    return(err);
+}
+
+static int
+testChildIndex(void) {
+    static const char *const exprs[] = {
+        "/doc/recs/rec[100]", "/doc/recs/node()[150]", "/doc/recs/*[70]",
+        "/doc/recs/rec[1000]", "/doc/recs/other[100]",
+        "(/doc/recs/rec)[last()]", "(/doc/recs/node())[last()]",
+        "(/doc/recs/*)[last()]", "(/doc/*/rec)[last()]",
+        "/doc/mixed/a[70]", "/doc/mixed/*[140]", "(/doc/mixed/a)[last()]",
+        "(/doc/mixed/b | /doc/recs/rec)[last()]"
+    };
+    xmlDocPtr doc;
+    xmlNodePtr root, recs, mixed, node;
+    xmlXPathContextPtr ctxt;
+    size_t j;
+    int i, err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    recs = xmlNewChild(root, NULL, BAD_CAST "recs", NULL);
+    mixed = xmlNewChild(root, NULL, BAD_CAST "mixed", NULL);
+    for (i = 0; i < 200; i++) {
+        xmlNewChild(recs, NULL, BAD_CAST "rec", NULL);
+        xmlAddChild(recs, xmlNewDocText(doc, BAD_CAST "\n"));
+        xmlNewChild(mixed, NULL, BAD_CAST (i % 2 ? "b" : "a"), NULL);
+    }
+    xmlDocSetNameIndex(doc, 1);
+
+    if ((xmlNthChild(recs, 101) != xmlNthElementChild(recs, 50)->next) ||
+        (xmlNthElementChild(mixed, 199) != mixed->last) ||
+        (xmlNthChild(mixed, 200) != NULL)) {
+        fprintf(stderr, "testChildIndex: wrong nth child\n");
+        err = 1;
+    }
+
+    ctxt = xmlXPathNewContext(doc);
+
+    for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+        err |= childIndexCompare(ctxt, exprs[j]);
+
+    /* Adding and removing children discards the tables */
+    for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+        xmlXPathFreeObject(xmlXPathEval(BAD_CAST exprs[j], ctxt));
+    xmlNthChild(recs, 100);
+    xmlAddPrevSibling(recs->children,
+                      xmlNewDocNode(doc, NULL, BAD_CAST "rec", NULL));
+    node = mixed->last;
+    xmlUnlinkNode(node);
+    xmlFreeNode(node);
+    xmlAddChild(recs, xmlNewDocComment(doc, BAD_CAST "c"));
+    for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+        err |= childIndexCompare(ctxt, exprs[j]);
+
+    if (xmlNthElementChild(recs, 100) != xmlNthChild(recs, 199)) {
+        fprintf(stderr, "testChildIndex: stale nth child\n");
+        err = 1;
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+parallelFilterCompare(xmlXPathContextPtr ctxt, const char *expr) {
+    xmlXPathObjectPtr seq, par;
+    int i, err = 0;
+
+    xmlXPathContextSetParallel(ctxt, 0, 0);
+    seq = xmlXPathEval(BAD_CAST expr, ctxt);
+    xmlXPathContextSetParallel(ctxt, 4, 100);
+    par = xmlXPathEval(BAD_CAST expr, ctxt);
+
+    if ((seq == NULL) || (par == NULL)) {
+        err = (seq != par);
+    } else if ((seq->type != par->type) ||
+               ((seq->type == XPATH_NODESET) &&
+                (seq->nodesetval->nodeNr != par->nodesetval->nodeNr)) ||
+               ((seq->type == XPATH_NUMBER) &&
+                (seq->floatval != par->floatval))) {
+        err = 1;
+    } else if (seq->type == XPATH_NODESET) {
+        for (i = 0; i < seq->nodesetval->nodeNr; i++) {
+            if (seq->nodesetval->nodeTab[i] != par->nodesetval->nodeTab[i])
+                err = 1;
+        }
+    }
+    if (err)
+        fprintf(stderr, "testParallelFilter: %s: results differ\n", expr);
+
+    xmlXPathFreeObject(seq);
+    xmlXPathFreeObject(par);
+    return(err);
+}
+
+static int
+testParallelFilter(void) {
+    static const char *const exprs[] = {
+        "//a[@n='1']", "//a[b/c]", "//*[not(self::b)][position() < 3000]",
+        "count(//b[string-length(.) > 4 and ../@n != '2'])",
+        "//a[$missing]", "//a[p:f()]", "//a[last() - 10 < position()]"
+    };
+    xmlDocPtr doc;
+    xmlNodePtr root, a, b;
+    xmlXPathContextPtr ctxt;
+    char num[20];
+    size_t j;
+    int i, err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 5000; i++) {
+        snprintf(num, sizeof(num), "%d", i % 3);
+        a = xmlNewChild(root, NULL, BAD_CAST "a", NULL);
+        xmlNewProp(a, BAD_CAST "n", BAD_CAST num);
+        b = xmlNewChild(a, NULL, BAD_CAST "b", BAD_CAST (i % 5 ? "t" : "text"));
+        if (i % 7 == 0)
+            xmlNewChild(b, NULL, BAD_CAST "c", NULL);
+    }
+
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathSetErrorHandler(ctxt, ignoreError, NULL);
+
+    if (xmlXPathContextSetParallel(ctxt, 4, 100) == 0) {
+        for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+            err |= parallelFilterCompare(ctxt, exprs[j]);
+
+        /* The name index is detached from the document during evaluation */
+        xmlDocSetNameIndex(doc, 1);
+        for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+            err |= parallelFilterCompare(ctxt, exprs[j]);
+
+        /* The index of a frozen document is shared */
+        xmlDocSetFrozen(doc, 1);
+        for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+            err |= parallelFilterCompare(ctxt, exprs[j]);
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+testParallelFilterLazyIds(void) {
+    xmlBufferPtr buf;
+    xmlParserCtxtPtr pctxt;
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr res;
+    char item[60];
+    int i, err = 0;
+
+    buf = xmlBufferCreate();
+    xmlBufferCCat(buf, "<!DOCTYPE doc [\n"
+                  "<!ATTLIST item id ID #REQUIRED ref IDREF #REQUIRED>\n"
+                  "]>\n<doc>");
+    for (i = 0; i < 20000; i++) {
+        snprintf(item, sizeof(item), "<item id='i%d' ref='i%d'/>",
+                 i, 19999 - i);
+        xmlBufferCCat(buf, item);
+    }
+    xmlBufferCCat(buf, "</doc>\n");
+
+    pctxt = xmlNewParserCtxt();
+    xmlCtxtSetLazyIds(pctxt, 1);
+    doc = xmlCtxtReadMemory(pctxt, (const char *) xmlBufferContent(buf),
+                            xmlBufferLength(buf), NULL, NULL, 0);
+    xmlFreeParserCtxt(pctxt);
+    xmlBufferFree(buf);
+    if (doc == NULL) {
+        fprintf(stderr, "testParallelFilterLazyIds: parsing failed\n");
+        return(1);
+    }
+
+    /* The IDs are collected before the workers start */
+    ctxt = xmlXPathNewContext(doc);
+    if (xmlXPathContextSetParallel(ctxt, 4, 100) == 0) {
+        res = xmlXPathEval(BAD_CAST "count(//item[id(@ref)])", ctxt);
+        if ((res == NULL) || (res->type != XPATH_NUMBER) ||
+            (res->floatval != 20000)) {
+            fprintf(stderr, "testParallelFilterLazyIds: wrong count\n");
+            err = 1;
+        }
+        xmlXPathFreeObject(res);
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+/*
+ * Fingerprint of the fields of all nodes which XPath evaluation
+ * could write to.
+ */
+static unsigned long
+frozenDocHash(xmlNodePtr node, unsigned long hash) {
+    xmlAttrPtr attr;
+
+    for (; node != NULL; node = node->next) {
+        hash = hash * 31 + (uintptr_t) node->content;
+        hash = hash * 31 + (uintptr_t) node->children;
+        hash = hash * 31 + (uintptr_t) node->next;
+        hash = hash * 31 + (uintptr_t) node->_private;
+        hash = hash * 31 + (uintptr_t) node->psvi;
+        hash = hash * 31 + node->extra;
+        if (node->type == XML_ELEMENT_NODE) {
+            hash = hash * 31 + (uintptr_t) node->nsDef;
+            for (attr = node->properties; attr != NULL; attr = attr->next) {
+                hash = hash * 31 + (uintptr_t) attr->next;
+                hash = frozenDocHash(attr->children, hash);
+            }
+        }
+        hash = frozenDocHash(node->children, hash);
+    }
+
+    return(hash);
+}
+
+static double
+frozenEval(xmlXPathContextPtr ctxt, const char *expr) {
+    xmlXPathObjectPtr res;
+    double ret;
+
+    res = xmlXPathEval(BAD_CAST expr, ctxt);
+    if (res == NULL)
+        return(-1);
+    ret = xmlXPathCastToNumber(res);
+    xmlXPathFreeObject(res);
+
+    return(ret);
+}
+
+typedef struct {
+    xmlDocPtr doc;
+    const char *const *exprs;
+    const double *values;
+    int nbExprs;
+    int err;
+} testFrozenTask;
+
+static void
+testFrozenRun(void *data) {
+    testFrozenTask *task = data;
+    xmlXPathContextPtr ctxt;
+    int i, j;
+
+    ctxt = xmlXPathNewContext(task->doc);
+    if (ctxt == NULL) {
+        task->err = 1;
+        return;
+    }
+    xmlXPathRegisterNs(ctxt, BAD_CAST "p", BAD_CAST "urn:p");
+
+    for (j = 0; j < 20; j++) {
+        for (i = 0; i < task->nbExprs; i++) {
+            if (frozenEval(ctxt, task->exprs[i]) !=
+                task->values[i])
+                task->err = 1;
+        }
+    }
+
+    xmlXPathFreeContext(ctxt);
+}
+
+static int
+testFrozenDoc(void) {
+    static const char *const exprs[] = {
+        "count(//rec)", "count(//rec[@n='3'])", "count(//rec[@p:k='x'])",
+        "count(/doc/rec[150]/preceding-sibling::rec)",
+        "count(/doc/rec[last()]/namespace::*)",
+        "count(//rec/v | //rec[@n='1'] | //v[. = 'v12'])",
+        "count((//v)[last()]/ancestor::*)", "sum(//rec[@n='2']/v/@i)"
+    };
+    double values[sizeof(exprs) / sizeof(exprs[0])];
+    testFrozenTask tasks[8];
+    xmlTaskGroup *group;
+    xmlDocPtr doc;
+    xmlNodePtr root, rec, v;
+    xmlNsPtr ns;
+    xmlXPathContextPtr ctxt;
+    unsigned long hash;
+    char buf[20];
+    int nbExprs = sizeof(exprs) / sizeof(exprs[0]);
+    int i, err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    ns = xmlNewNs(root, BAD_CAST "urn:p", BAD_CAST "p");
+    for (i = 0; i < 200; i++) {
+        snprintf(buf, sizeof(buf), "%d", i % 5);
+        rec = xmlNewChild(root, NULL, BAD_CAST "rec", NULL);
+        xmlNewProp(rec, BAD_CAST "n", BAD_CAST buf);
+        xmlNewNsProp(rec, ns, BAD_CAST "k", BAD_CAST (i % 3 ? "y" : "x"));
+        snprintf(buf, sizeof(buf), "v%d", i);
+        v = xmlNewChild(rec, NULL, BAD_CAST "v", BAD_CAST buf);
+        snprintf(buf, sizeof(buf), "%d", i);
+        xmlNewProp(v, BAD_CAST "i", BAD_CAST buf);
+    }
+
+    /* Expected results without index */
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "p", BAD_CAST "urn:p");
+    for (i = 0; i < nbExprs; i++)
+        values[i] = frozenEval(ctxt, exprs[i]);
+    xmlXPathFreeContext(ctxt);
+
+    if ((xmlDocSetFrozen(doc, 1) != 0) ||
+        ((doc->properties & XML_DOC_FROZEN) == 0)) {
+        fprintf(stderr, "testFrozenDoc: freezing failed\n");
+        err = 1;
+    }
+    if (xmlXPathOrderDocElems(doc) != -1) {
+        fprintf(stderr, "testFrozenDoc: frozen document was ordered\n");
+        err = 1;
+    }
+
+    hash = frozenDocHash((xmlNodePtr) doc, 0);
+
+    group = xmlNewTaskGroup();
+    for (i = 0; i < 8; i++) {
+        tasks[i].doc = doc;
+        tasks[i].exprs = exprs;
+        tasks[i].values = values;
+        tasks[i].nbExprs = nbExprs;
+        tasks[i].err = 0;
+        if (xmlTaskGroupSubmit(group, testFrozenRun, &tasks[i]) < 0)
+            testFrozenRun(&tasks[i]);
+    }
+    xmlFreeTaskGroup(group);
+
+    for (i = 0; i < 8; i++) {
+        if (tasks[i].err) {
+            fprintf(stderr, "testFrozenDoc: wrong result in task %d\n", i);
+            err = 1;
+        }
+    }
+    if (frozenDocHash((xmlNodePtr) doc, 0) != hash) {
+        fprintf(stderr, "testFrozenDoc: evaluation wrote to the tree\n");
+        err = 1;
+    }
+
+    /* Modifying the document unfreezes it */
+    xmlNewChild(root, NULL, BAD_CAST "rec", NULL);
+    if (doc->properties & XML_DOC_FROZEN) {
+        fprintf(stderr, "testFrozenDoc: modified document still frozen\n");
+        err = 1;
+    }
+    ctxt = xmlXPathNewContext(doc);
+    if (frozenEval(ctxt, "count(//rec)") != 201) {
+        fprintf(stderr, "testFrozenDoc: stale index after unfreezing\n");
+        err = 1;
+    }
+    xmlXPathFreeContext(ctxt);
+
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+testFrozenLazyIds(void) {
+    static const char *const exprs[] = {
+        "count(id('i1 i5 i7'))", "count(id('i150')/preceding-sibling::*)",
+        "count(id(//item[@ref]/@ref))", "count(id('missing'))"
+    };
+    static const double values[] = { 3, 150, 100, 0 };
+    testFrozenTask tasks[8];
+    xmlTaskGroup *group;
+    xmlParserCtxtPtr ctxt;
+    xmlBufferPtr buf;
+    xmlDocPtr doc;
+    char item[60];
+    int i, err = 0;
+
+    buf = xmlBufferCreate();
+    xmlBufferCat(buf, BAD_CAST
+        "<!DOCTYPE doc [\n"
+        "<!ATTLIST item id ID #IMPLIED ref IDREF #IMPLIED>\n"
+        "]>\n"
+        "<doc>");
+    for (i = 0; i < 200; i++) {
+        if (i % 2)
+            snprintf(item, sizeof(item), "<item id='i%d' ref='i%d'/>",
+                     i, i - 1);
+        else
+            snprintf(item, sizeof(item), "<item id='i%d'/>", i);
+        xmlBufferCat(buf, BAD_CAST item);
+    }
+    xmlBufferCat(buf, BAD_CAST "</doc>");
+
+    ctxt = xmlNewParserCtxt();
+    xmlCtxtSetLazyIds(ctxt, 1);
+    doc = xmlCtxtReadMemory(ctxt, (const char *) xmlBufferContent(buf),
+                            xmlBufferLength(buf), NULL, NULL, 0);
+    xmlFreeParserCtxt(ctxt);
+    xmlBufferFree(buf);
+    if (doc == NULL) {
+        fprintf(stderr, "testFrozenLazyIds: parsing failed\n");
+        return(1);
+    }
+
+    /* Lazy IDs must be collected before other threads can see them */
+    if ((xmlDocSetFrozen(doc, 1) != 0) || (doc->ids == NULL)) {
+        fprintf(stderr, "testFrozenLazyIds: IDs not collected\n");
+        err = 1;
+    }
+
+    group = xmlNewTaskGroup();
+    for (i = 0; i < 8; i++) {
+        tasks[i].doc = doc;
+        tasks[i].exprs = exprs;
+        tasks[i].values = values;
+        tasks[i].nbExprs = sizeof(exprs) / sizeof(exprs[0]);
+        tasks[i].err = 0;
+        if (xmlTaskGroupSubmit(group, testFrozenRun, &tasks[i]) < 0)
+            testFrozenRun(&tasks[i]);
+    }
+    xmlFreeTaskGroup(group);
+
+    for (i = 0; i < 8; i++) {
+        if (tasks[i].err) {
+            fprintf(stderr, "testFrozenLazyIds: wrong result in task %d\n",
+                    i);
+            err = 1;
+        }
+    }
+
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+iterateCompare(xmlXPathContextPtr ctxt, const char *expr) {
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr obj;
+    xmlXPathIteratorPtr iter;
+    xmlNodeSetPtr set;
+    xmlNodePtr node;
+    int i = 0, res, err = 0;
+
+    comp = xmlXPathCtxtCompile(ctxt, BAD_CAST expr);
+    if (comp == NULL) {
+        fprintf(stderr, "testIterate: %s: compilation failed\n", expr);
+        return(1);
+    }
+    obj = xmlXPathCompiledEval(comp, ctxt);
+    iter = xmlXPathCompiledIterate(comp, ctxt);
+    if ((obj == NULL) || (iter == NULL)) {
+        fprintf(stderr, "testIterate: %s: evaluation failed\n", expr);
+        err = 1;
+        goto done;
+    }
+
+    set = obj->nodesetval;
+    while ((res = xmlXPathIteratorNext(iter, &node)) == 1) {
+        if ((set == NULL) || (i >= set->nodeNr) ||
+            ((node->type == XML_NAMESPACE_DECL) ?
+             (!xmlStrEqual(((xmlNsPtr) node)->href,
+                           ((xmlNsPtr) set->nodeTab[i])->href)) :
+             (node != set->nodeTab[i])))
+            err = 1;
+        i++;
+    }
+    if ((res != 0) || ((set != NULL) && (i != set->nodeNr)) ||
+        ((set == NULL) && (i != 0)))
+        err = 1;
+    if (err)
+        fprintf(stderr, "testIterate: %s: results differ\n", expr);
+
+done:
+    xmlXPathFreeIterator(iter);
+    xmlXPathFreeObject(obj);
+    xmlXPathFreeCompExpr(comp);
+    return(err);
+}
+
+static int
+testIterate(void) {
+    static const char *const exprs[] = {
+        "/", ".", "//a", "/doc/a/b", "//b//c", "//*", "//node()",
+        "//text()", "//comment() | //processing-instruction()",
+        "//@*", "//a/@n", "//a[@n='1']/b", "//a[b/c]//c",
+        "descendant-or-self::node()/self::b", "//x:e", "//x:*/@x:*",
+        "//a[not(@n='2') and b]", "//a[2]", "//a[last()]/b",
+        "//b/..", "//namespace::*", "//a[b][@n != '0']/b/text()",
+        "//a[contains(b, 'x')]"
+    };
+    static const char *const relExprs[] = {
+        ".", "b", "b/c", ".//c", "self::a/@n", "descendant::node()"
+    };
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    xmlXPathCompExprPtr comp;
+    xmlXPathIteratorPtr iter;
+    xmlXPathObjectPtr obj, count;
+    xmlNodePtr node;
+    size_t j;
+    int err = 0;
+
+    doc = xmlReadDoc(BAD_CAST
+        "<!DOCTYPE doc [<!ENTITY e 'ent'>]>\n"
+        "<doc xmlns:x='urn:x'><?pi?><a n='0'>t<b>x<c/></b><!--c--></a>"
+        "<a n='1'><b><![CDATA[cd]]><c><c/></c></b>&e;</a>"
+        "<a n='2' x:n='3'><x:e x:m='4'><b/></x:e></a><a><b/></a></doc>",
+        NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "x", BAD_CAST "urn:x");
+
+    for (j = 0; j < sizeof(exprs) / sizeof(exprs[0]); j++)
+        err |= iterateCompare(ctxt, exprs[j]);
+
+    ctxt->node = xmlDocGetRootElement(doc)->children->next;
+    for (j = 0; j < sizeof(relExprs) / sizeof(relExprs[0]); j++)
+        err |= iterateCompare(ctxt, relExprs[j]);
+
+    /* Stopping early */
+    comp = xmlXPathCompile(BAD_CAST "//c");
+    iter = xmlXPathCompiledIterate(comp, ctxt);
+    if ((xmlXPathIteratorNext(iter, &node) != 1) ||
+        (!xmlStrEqual(node->name, BAD_CAST "c"))) {
+        fprintf(stderr, "testIterate: first node wrong\n");
+        err = 1;
+    }
+    xmlXPathFreeIterator(iter);
+    xmlXPathFreeCompExpr(comp);
+
+    /* Aggregates over location paths are evaluated lazily */
+    obj = xmlXPathEval(BAD_CAST "//a[b]//c", ctxt);
+    count = xmlXPathEval(BAD_CAST "count(//a[b]//c)", ctxt);
+    if ((obj == NULL) || (count == NULL) ||
+        (count->floatval != obj->nodesetval->nodeNr) ||
+        (xmlXPathEvalPredicate(ctxt, obj) != 1)) {
+        fprintf(stderr, "testIterate: count differs\n");
+        err = 1;
+    }
+    xmlXPathFreeObject(obj);
+    xmlXPathFreeObject(count);
+    comp = xmlXPathCompile(BAD_CAST "//a[@n='9']");
+    if ((xmlXPathCompiledEvalToBoolean(comp, ctxt) != 0) ||
+        (!xmlXPathCastToBoolean(obj = xmlXPathEval(BAD_CAST "not(//a[@n='9'])",
+                                                   ctxt)))) {
+        fprintf(stderr, "testIterate: boolean differs\n");
+        err = 1;
+    }
+    xmlXPathFreeObject(obj);
+    xmlXPathFreeCompExpr(comp);
+
+    /* Non node-set results are an error */
+    xmlXPathSetErrorHandler(ctxt, ignoreError, NULL);
+    comp = xmlXPathCompile(BAD_CAST "count(//a)");
+    iter = xmlXPathCompiledIterate(comp, ctxt);
+    if ((iter != NULL) || (ctxt->lastError.code != XML_XPATH_INVALID_TYPE)) {
+        fprintf(stderr, "testIterate: expected type error\n");
+        err = 1;
+    }
+    xmlXPathFreeIterator(iter);
+    xmlXPathFreeCompExpr(comp);
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+testEvalMulti(void) {
+    static const char *const exprs[] = {
+        "/doc/a/b", "//a", "//a/@n", "//b//c", "//x:*/@x:*", "count(//a)",
+        "//a[@n='1']/b", "//a[2]", "//text()", "//b/..", "//c", "/"
+    };
+    xmlXPathCompExprPtr comps[sizeof(exprs) / sizeof(exprs[0])];
+    xmlXPathObjectPtr results[sizeof(exprs) / sizeof(exprs[0])];
+    xmlXPathObjectPtr obj;
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    int i, j, nb = sizeof(exprs) / sizeof(exprs[0]), err = 0;
+
+    doc = xmlReadDoc(BAD_CAST
+        "<!DOCTYPE doc [<!ENTITY e 'ent'>]>\n"
+        "<doc xmlns:x='urn:x'><a n='0'>t<b>x<c/></b><!--c--></a>"
+        "<a n='1'><b><c><c/></c></b>&e;</a>"
+        "<a n='2' x:n='3'><x:e x:m='4'><b/></x:e></a></doc>",
+        NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "x", BAD_CAST "urn:x");
+
+    for (i = 0; i < nb; i++)
+        comps[i] = xmlXPathCtxtCompile(ctxt, BAD_CAST exprs[i]);
+
+    if (xmlXPathCompiledEvalMulti(comps, nb, ctxt, results) != 0) {
+        fprintf(stderr, "testEvalMulti: evaluation failed\n");
+        err = 1;
+    }
+
+    for (i = 0; i < nb; i++) {
+        int diff = 0;
+
+        obj = xmlXPathCompiledEval(comps[i], ctxt);
+        if ((obj == NULL) || (results[i] == NULL) ||
+            (obj->type != results[i]->type)) {
+            diff = 1;
+        } else if (obj->type == XPATH_NODESET) {
+            if (obj->nodesetval->nodeNr != results[i]->nodesetval->nodeNr) {
+                diff = 1;
+            } else {
+                for (j = 0; j < obj->nodesetval->nodeNr; j++) {
+                    if (obj->nodesetval->nodeTab[j] !=
+                        results[i]->nodesetval->nodeTab[j])
+                        diff = 1;
+                }
+            }
+        } else if (obj->floatval != results[i]->floatval) {
+            diff = 1;
+        }
+        if (diff) {
+            fprintf(stderr, "testEvalMulti: %s: results differ\n", exprs[i]);
+            err = 1;
+        }
+
+        xmlXPathFreeObject(obj);
+        xmlXPathFreeObject(results[i]);
+        xmlXPathFreeCompExpr(comps[i]);
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+/*
+ * Compare the specialized evaluators of simple steps with the generic
+ * evaluator, which is used for steps with predicates.
+ */
+static int
+testFastSteps(void) {
+    static const char *const exprs[][2] = {
+        { "/doc/a/b", "/doc/a/b[true()]" },
+        { "//b", "//b[true()]" },
+        { "//a/descendant::b", "//a/descendant::b[true()]" },
+        { "//b/c", "//b/c[true()]" },
+        { "//@n", "//@n[true()]" },
+        { "//a/@x:n", "//a/@x:n[true()]" },
+        { "//x:e", "//x:e[true()]" },
+        { "//a/text()", "//a/text()[true()]" },
+        { "//a/b/text()", "//a/b/text()[true()]" },
+        { "/doc/a/x:e/b", "/doc/a/x:e/b[true()]" },
+        { "boolean(//a/b)", "boolean(//a/b[true()])" },
+        { "count(//a/@n)", "count(//a/@n[true()])" }
+    };
+    xmlXPathObjectPtr fast, generic;
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    int i, j, nb = sizeof(exprs) / sizeof(exprs[0]), err = 0;
+
+    doc = xmlReadDoc(BAD_CAST
+        "<doc xmlns:x='urn:x'><a n='0'>t<b>x<c/></b><!--c--></a>"
+        "<a n='1'><a><b><c/></b></a><![CDATA[cd]]><b/></a>"
+        "<a n='2' x:n='3'><x:e x:m='4'><b/><x:b/></x:e></a></doc>",
+        NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "x", BAD_CAST "urn:x");
+
+    for (i = 0; i < nb; i++) {
+        int diff = 0;
+
+        fast = xmlXPathEval(BAD_CAST exprs[i][0], ctxt);
+        generic = xmlXPathEval(BAD_CAST exprs[i][1], ctxt);
+
+        if ((fast == NULL) || (generic == NULL) ||
+            (fast->type != generic->type)) {
+            diff = 1;
+        } else if (fast->type == XPATH_NODESET) {
+            if ((fast->nodesetval->nodeNr == 0) ||
+                (fast->nodesetval->nodeNr != generic->nodesetval->nodeNr)) {
+                diff = 1;
+            } else {
+                for (j = 0; j < fast->nodesetval->nodeNr; j++) {
+                    if (fast->nodesetval->nodeTab[j] !=
+                        generic->nodesetval->nodeTab[j])
+                        diff = 1;
+                }
+            }
+        } else if ((fast->boolval != generic->boolval) ||
+                   (fast->floatval != generic->floatval)) {
+            diff = 1;
+        }
+        if (diff) {
+            fprintf(stderr, "testFastSteps: %s: results differ\n",
+                    exprs[i][0]);
+            err = 1;
+        }
+
+        xmlXPathFreeObject(fast);
+        xmlXPathFreeObject(generic);
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+testNodeSetJoin(void) {
+    static const struct {
+        const char *expr;
+        double value;
+    } tests[] = {
+        { "count(//order[@cust = //customer/@id])", 80 },
+        { "count(//order[@cust != //customer/@id])", 100 },
+        { "//order/@cust = //customer/@id", 1 },
+        { "//order[@n >= 50]/@cust = //customer[@n >= 1020]/@id", 1 },
+        { "//order[@n >= 50][@n < 70]/@cust = //customer/@id", 0 },
+        { "//same/@v = //same/@v", 1 },
+        { "//same/@v != //same/@v", 0 },
+        { "//same/@v = //order/@cust", 0 },
+        { "//order/@n < //customer/@n", 1 },
+        { "//order/@n > //customer/@n", 0 },
+        { "//customer/@n >= //order/@n", 1 },
+        { "//order/@n <= //order/@n", 1 },
+        { "//order/@cust < //order/@n", 0 }
+    };
+    xmlXPathObjectPtr obj;
+    xmlDocPtr doc;
+    xmlNodePtr root, node;
+    xmlXPathContextPtr ctxt;
+    char buf[20];
+    int i, err = 0;
+
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    root = xmlNewDocNode(doc, NULL, BAD_CAST "doc", NULL);
+    xmlDocSetRootElement(doc, root);
+    for (i = 0; i < 100; i++) {
+        node = xmlNewChild(root, NULL, BAD_CAST "order", NULL);
+        snprintf(buf, sizeof(buf), "c%d", i % 70);
+        xmlNewProp(node, BAD_CAST "cust", BAD_CAST buf);
+        snprintf(buf, sizeof(buf), "%d", i);
+        xmlNewProp(node, BAD_CAST "n", BAD_CAST buf);
+    }
+    for (i = 0; i < 50; i++) {
+        node = xmlNewChild(root, NULL, BAD_CAST "customer", NULL);
+        snprintf(buf, sizeof(buf), "c%d", i);
+        xmlNewProp(node, BAD_CAST "id", BAD_CAST buf);
+        snprintf(buf, sizeof(buf), "%d", i + 1000);
+        xmlNewProp(node, BAD_CAST "n", BAD_CAST buf);
+    }
+    for (i = 0; i < 40; i++) {
+        node = xmlNewChild(root, NULL, BAD_CAST "same", NULL);
+        xmlNewProp(node, BAD_CAST "v", BAD_CAST "x");
+    }
+    ctxt = xmlXPathNewContext(doc);
+
+    for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); i++) {
+        double value;
+
+        obj = xmlXPathEval(BAD_CAST tests[i].expr, ctxt);
+        value = (obj == NULL) ? -1 : xmlXPathCastToNumber(obj);
+        if (value != tests[i].value) {
+            fprintf(stderr, "testNodeSetJoin: %s: got %f, expected %f\n",
+                    tests[i].expr, value, tests[i].value);
+            err = 1;
+        }
+        xmlXPathFreeObject(obj);
+    }
+
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+#ifdef LIBXML_DEBUG_ENABLED
+static int
+testXPathProfile(void) {
+    xmlXPathObjectPtr obj;
+    xmlXPathCompExprPtr comp;
+    xmlDocPtr doc;
+    xmlXPathContextPtr ctxt;
+    FILE *out;
+    char buf[2000];
+    size_t len;
+    int i, err = 0;
+
+    doc = xmlReadDoc(BAD_CAST "<doc><a/><b/><a/><a/></doc>", NULL, NULL, 0);
+    ctxt = xmlXPathNewContext(doc);
+    ctxt->flags |= XML_XPATH_PROFILE;
+    comp = xmlXPathCtxtCompile(ctxt, BAD_CAST "/doc/a");
+
+    for (i = 0; i < 2; i++) {
+        obj = xmlXPathCompiledEval(comp, ctxt);
+        if ((obj == NULL) || (obj->nodesetval == NULL) ||
+            (obj->nodesetval->nodeNr != 3)) {
+            fprintf(stderr, "testXPathProfile: wrong result\n");
+            err = 1;
+        }
+        xmlXPathFreeObject(obj);
+    }
+
+    out = tmpfile();
+    if (out == NULL) {
+        fprintf(stderr, "testXPathProfile: can't create temp file\n");
+        err = 1;
+        goto done;
+    }
+    xmlXPathDebugDumpProfile(out, comp, 0);
+    rewind(out);
+    len = fread(buf, 1, sizeof(buf) - 1, out);
+    buf[len] = 0;
+    fclose(out);
+    if (strstr(buf, "'child' 'name' 'node' a  "
+                    "[evals 2, visited 8, produced 6,") == NULL) {
+        fprintf(stderr, "testXPathProfile: unexpected profile:\n%s", buf);
+        err = 1;
+    }
+
+done:
+    xmlXPathFreeCompExpr(comp);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+typedef struct {
+    xmlDocPtr doc;
+    xmlXPathCompExprPtr comp;
+    int factor;
+    int err;
+} testSharedCompTask;
+
+static void
+testSharedCompDouble(xmlXPathParserContextPtr ctxt, int nargs) {
+    double val;
+
+    if (nargs != 1) {
+        xmlXPathErr(ctxt, XPATH_INVALID_ARITY);
+        return;
+    }
+    val = xmlXPathPopNumber(ctxt);
+    xmlXPathValuePush(ctxt, xmlXPathNewFloat(val * 2));
+}
+
+static void
+testSharedCompNegate(xmlXPathParserContextPtr ctxt, int nargs) {
+    double val;
+
+    if (nargs != 1) {
+        xmlXPathErr(ctxt, XPATH_INVALID_ARITY);
+        return;
+    }
+    val = xmlXPathPopNumber(ctxt);
+    xmlXPathValuePush(ctxt, xmlXPathNewFloat(-val));
+}
+
+static void
+testSharedCompRun(void *arg) {
+    testSharedCompTask *task = arg;
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr obj;
+    int i;
+
+    ctxt = xmlXPathNewContext(task->doc);
+    ctxt->flags |= XML_XPATH_PROFILE;
+    xmlXPathRegisterFuncNS(ctxt, BAD_CAST "scale", BAD_CAST "urn:t",
+                           (task->factor == 2) ? testSharedCompDouble :
+                                                 testSharedCompNegate);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "t", BAD_CAST "urn:t");
+
+    for (i = 0; i < 20; i++) {
+        obj = xmlXPathCompiledEval(task->comp, ctxt);
+        if ((obj == NULL) || (obj->type != XPATH_NUMBER) ||
+            (obj->floatval != 3 * task->factor + 1))
+            task->err = 1;
+        xmlXPathFreeObject(obj);
+    }
+
+    xmlXPathFreeContext(ctxt);
+}
+
+static int
+testXPathSharedComp(void) {
+    testSharedCompTask tasks[8];
+    xmlTaskGroup *group;
+    xmlXPathCompExprPtr comp;
+    xmlDocPtr doc;
+    FILE *out;
+    char buf[4000];
+    size_t len;
+    int i, err = 0;
+
+    doc = xmlReadDoc(BAD_CAST "<doc><a/><b/><a/><a/></doc>", NULL, NULL, 0);
+    comp = xmlXPathCompile(BAD_CAST "t:scale(count(/doc/a)) + count(//b)");
+    if (comp == NULL) {
+        fprintf(stderr, "testXPathSharedComp: compilation failed\n");
+        xmlFreeDoc(doc);
+        return(1);
+    }
+
+    /*
+     * Every context binds the extension function to a different
+     * implementation, which must not be cached in the shared steps.
+     */
+    group = xmlNewTaskGroup();
+    for (i = 0; i < 8; i++) {
+        tasks[i].doc = doc;
+        tasks[i].comp = comp;
+        tasks[i].factor = (i % 2) ? 2 : -1;
+        tasks[i].err = 0;
+        if (xmlTaskGroupSubmit(group, testSharedCompRun, &tasks[i]) < 0)
+            testSharedCompRun(&tasks[i]);
+    }
+    xmlFreeTaskGroup(group);
+
+    for (i = 0; i < 8; i++) {
+        if (tasks[i].err) {
+            fprintf(stderr, "testXPathSharedComp: wrong result in task %d\n",
+                    i);
+            err = 1;
+        }
+    }
+
+    /* Counters of all evaluations are merged */
+    out = tmpfile();
+    if (out == NULL) {
+        fprintf(stderr, "testXPathSharedComp: can't create temp file\n");
+        err = 1;
+        goto done;
+    }
+    xmlXPathDebugDumpProfile(out, comp, 0);
+    rewind(out);
+    len = fread(buf, 1, sizeof(buf) - 1, out);
+    buf[len] = 0;
+    fclose(out);
+    if (strstr(buf, "FUNCTION t:scale(1 args)  [evals 160,") == NULL) {
+        fprintf(stderr, "testXPathSharedComp: unexpected profile:\n%s", buf);
+        err = 1;
+    }
+
+done:
+    xmlXPathFreeCompExpr(comp);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+#endif /* LIBXML_DEBUG_ENABLED */
+
+static int
+testThreadCache(void) {
+    xmlXPathObjectPtr obj;
+    xmlXPathContextPtr ctxt;
+    xmlDocPtr doc;
+    int i, err = 0;
+
+    doc = xmlReadDoc(BAD_CAST "<doc><a/><a/><a/></doc>", NULL, NULL, 0);
+    xmlXPathSetThreadCacheSize(10);
+
+    /* Contexts start with the objects of previously freed ones */
+    for (i = 0; i < 5; i++) {
+        ctxt = xmlXPathNewContext(doc);
+        if (i == 3)
+            xmlXPathContextSetCache(ctxt, 0, 0, 0);
+        obj = xmlXPathEval(BAD_CAST "count(/doc/a | /doc/a[2]) + "
+                                    "string-length(string(/doc))", ctxt);
+        if ((obj == NULL) || (obj->floatval != 3)) {
+            fprintf(stderr, "testThreadCache: wrong result\n");
+            err = 1;
+        }
+        xmlXPathFreeObject(obj);
+        xmlXPathFreeContext(ctxt);
+    }
+
+    xmlXPathSetThreadCacheSize(0);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+static int
+testNumberRoundTrip(void) {
+    static const struct {
+        double val;
+        const char *str;
+    } tests[] = {
+        { 0.1, "0.1" },
+        { 0.1 + 0.2, "0.30000000000000004" },
+        { 1.0 / 3.0, "0.3333333333333333" },
+        { 123.456, "123.456" },
+        { -2.5e-3, "-0.0025" },
+        { 1e-7, "1e-07" },
+        { 5e-324, "5e-324" },
+        { 1.7976931348623157e308, "1.7976931348623157e+308" },
+        { 65536.125, "65536.125" },
+        { 999999999.75, "999999999.75" }
+    };
+    unsigned long long state = 1;
+    xmlChar *str;
+    double val;
+    size_t i;
+    int err = 0;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        str = xmlXPathCastNumberToString(tests[i].val);
+        if ((str == NULL) || (strcmp((char *) str, tests[i].str) != 0)) {
+            fprintf(stderr, "testNumberRoundTrip: %s formatted as %s\n",
+                    tests[i].str, str ? (char *) str : "NULL");
+            err = 1;
+        }
+        xmlFree(str);
+        val = xmlXPathCastStringToNumber(BAD_CAST tests[i].str);
+        if (val != tests[i].val) {
+            fprintf(stderr, "testNumberRoundTrip: %s parsed as %.17g\n",
+                    tests[i].str, val);
+            err = 1;
+        }
+    }
+
+    /* Arbitrary bit patterns */
+    for (i = 0; i < 100000; i++) {
+        unsigned long long bits;
+
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        bits = state;
+        memcpy(&val, &bits, sizeof(val));
+        if (xmlXPathIsNaN(val) || xmlXPathIsInf(val))
+            continue;
+
+        str = xmlXPathCastNumberToString(val);
+        if ((str == NULL) || (xmlXPathCastStringToNumber(str) != val)) {
+            fprintf(stderr, "testNumberRoundTrip: %.17g doesn't round-trip "
+                    "via %s\n", val, str ? (char *) str : "NULL");
+            err = 1;
+        }
+        xmlFree(str);
+        if (err)
+            break;
+    }
+
+    return(err);
+}
+
+/*
+ * Namespace URIs are compared by ID. Check name tests against
+ * several declarations of the same URI, URIs sharing a prefix and
+ * URIs interned again after the documents holding them were freed.
+ */
+static int
+testXPathNsIds(void) {
+    static const char *const exprs[] = {
+        "count(//u:a)", "count(//u:*)", "count(//@u:x)",
+        "count(//v:a)", "count(//w:a)", "count(/r/*/u:a)"
+    };
+    static const double values[] = { 3, 4, 2, 1, 0, 1 };
+    xmlDocPtr doc, other;
+    xmlNodePtr root;
+    xmlNsPtr ns;
+    xmlXPathContextPtr ctxt;
+    int i, round, err = 0;
+
+    for (round = 0; round < 2; round++) {
+        doc = xmlReadDoc(BAD_CAST
+            "<r xmlns:p='urn:ns'>"
+            "<p:a p:x='1'/>"
+            "<q:b xmlns:q='urn:ns'><q:a/></q:b>"
+            "<a xmlns='urn:ns' xmlns:o='urn:ns2' o:x='2' p:x='3'/>"
+            "<a xmlns='urn:ns2'/>"
+            "</r>", NULL, NULL, 0);
+        ctxt = xmlXPathNewContext(doc);
+        xmlXPathRegisterNs(ctxt, BAD_CAST "u", BAD_CAST "urn:ns");
+        xmlXPathRegisterNs(ctxt, BAD_CAST "v", BAD_CAST "urn:ns2");
+        xmlXPathRegisterNs(ctxt, BAD_CAST "w", BAD_CAST "urn:n");
+
+        for (i = 0; i < (int) (sizeof(exprs) / sizeof(exprs[0])); i++) {
+            double val = frozenEval(ctxt, exprs[i]);
+
+            if (val != values[i]) {
+                fprintf(stderr, "testXPathNsIds: %s returned %f\n",
+                        exprs[i], val);
+                err = 1;
+            }
+        }
+
+        xmlXPathFreeContext(ctxt);
+        xmlFreeDoc(doc);
+    }
+
+    /*
+     * IDs come from the dictionary of each document. Nodes moved from
+     * another document and namespaces whose URI was replaced must
+     * still compare by string.
+     */
+    doc = xmlReadDoc(BAD_CAST
+        "<r><p:a xmlns:p='urn:ns'/><q:a xmlns:q='urn:ns'/></r>",
+        NULL, NULL, 0);
+    other = xmlReadDoc(BAD_CAST "<p:a xmlns:p='urn:ns'/>", NULL, NULL, 0);
+    root = xmlDocGetRootElement(doc);
+    ns = xmlLastElementChild(root)->nsDef;
+    xmlAddChild(root, xmlDocCopyNode(xmlDocGetRootElement(other), doc, 1));
+    xmlFreeDoc(other);
+    /* The new string is likely allocated at the old address */
+    xmlFree((xmlChar *) ns->href);
+    ns->href = xmlStrdup(BAD_CAST "urn:oo");
+
+    ctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(ctxt, BAD_CAST "u", BAD_CAST "urn:ns");
+    xmlXPathRegisterNs(ctxt, BAD_CAST "o", BAD_CAST "urn:oo");
+    if ((frozenEval(ctxt, "count(//u:a)") != 2) ||
+        (frozenEval(ctxt, "count(//o:a)") != 1)) {
+        fprintf(stderr, "testXPathNsIds: wrong result after changes\n");
+        err = 1;
+    }
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(doc);
+
+    return(err);
+}
+
+/*
+ * The core function hash table and the special numbers are set up at
+ * compile time. Check that every core function is found.
+ */
+static int
+testXPathCoreFunctions(void) {
+    static const char *const names[] = {
+        "boolean", "ceiling", "count", "concat", "contains", "id",
+        "false", "floor", "last", "lang", "local-name", "not", "name",
+        "namespace-uri", "normalize-space", "number", "position",
+        "round", "string", "string-length", "starts-with", "substring",
+        "substring-before", "substring-after", "sum", "true", "translate"
+    };
+    xmlXPathContextPtr ctxt;
+    xmlXPathObjectPtr res;
+    size_t i;
+    int err = 0;
+
+    ctxt = xmlXPathNewContext(NULL);
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (xmlXPathFunctionLookup(ctxt, BAD_CAST names[i]) == NULL) {
+            fprintf(stderr, "testXPathCoreFunctions: %s not found\n",
+                    names[i]);
+            err = 1;
+        }
+    }
+    if ((xmlXPathFunctionLookup(ctxt, BAD_CAST "no-such") != NULL) ||
+        (xmlXPathFunctionLookup(ctxt, BAD_CAST "") != NULL)) {
+        fprintf(stderr, "testXPathCoreFunctions: found unknown function\n");
+        err = 1;
+    }
+
+    res = xmlXPathEval(BAD_CAST "number('x')", ctxt);
+    if ((res == NULL) || (!xmlXPathIsNaN(res->floatval))) {
+        fprintf(stderr, "testXPathCoreFunctions: expected NaN\n");
+        err = 1;
+    }
+    xmlXPathFreeObject(res);
+
+    res = xmlXPathEval(BAD_CAST "-1 div 0", ctxt);
+    if ((res == NULL) || (xmlXPathIsInf(res->floatval) != -1)) {
+        fprintf(stderr, "testXPathCoreFunctions: expected -Infinity\n");
+        err = 1;
+    }
+    xmlXPathFreeObject(res);
+
+    xmlXPathFreeContext(ctxt);
+    return(err);
+}
+#endif /* LIBXML_XPATH_ENABLED */
+
+#ifdef LIBXML_REGEXP_ENABLED
+static int
+testRegexpCache(void) {
+    const xmlChar *date = BAD_CAST "\\d{4}-\\d{2}-\\d{2}";
+    xmlRegexpPtr a, b, c;
+    int err = 0;
+
+    a = xmlRegexpCompile(date);
+    b = xmlRegexpCompile(date);
+    c = xmlRegexpCompile(BAD_CAST "[A-Z]{3}");
+    if ((a == NULL) || (b == NULL) || (c == NULL)) {
+        fprintf(stderr, "testRegexpCache: compilation failed\n");
+        err = 1;
+        goto done;
+    }
+    if ((a != b) || (a == c)) {
+        fprintf(stderr, "testRegexpCache: wrong sharing\n");
+        err = 1;
+    }
+
+    /* Still usable after one user freed it */
+    xmlRegFreeRegexp(a);
+    a = NULL;
+    if ((xmlRegexpExec(b, BAD_CAST "2024-01-31") != 1) ||
+        (xmlRegexpExec(b, BAD_CAST "2024-1-31") != 0)) {
+        fprintf(stderr, "testRegexpCache: wrong result\n");
+        err = 1;
+    }
+
+    /* Compiled again after the last user freed it */
+    xmlRegFreeRegexp(b);
+    b = xmlRegexpCompile(date);
+    if ((b == NULL) || (xmlRegexpExec(b, BAD_CAST "2024-01-31") != 1)) {
+        fprintf(stderr, "testRegexpCache: recompilation failed\n");
+        err = 1;
+    }
+
+done:
+    xmlRegFreeRegexp(a);
+    xmlRegFreeRegexp(b);
+    xmlRegFreeRegexp(c);
+    return(err);
+}
+
+typedef struct {
+    xmlRegexpPtr regexp;
+    int err;
+} testRegexpSharedTask;
+
+static const char *const testRegexpSharedInputs[] = {
+    "abc", "abc-12", "z-99-00", "\xC3\xA9t\xC3\xA9-01",
+    "\xE4\xB8\xAD\xE6\x96\x87", "\xF0\x9F\x98\x80", "abc-1",
+    "-12", "ab1", "\xC3\xA8", ""
+};
+static const int testRegexpSharedResults[] = {
+    1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0
+};
+
+static void
+testRegexpSharedRun(void *data) {
+    testRegexpSharedTask *task = data;
+    int nb = sizeof(testRegexpSharedResults) /
+             sizeof(testRegexpSharedResults[0]);
+    int i, j;
+
+    for (j = 0; j < 100; j++) {
+        for (i = 0; i < nb; i++) {
+            int k = (i + j) % nb;
+
+            if (xmlRegexpExec(task->regexp,
+                              BAD_CAST testRegexpSharedInputs[k]) !=
+                testRegexpSharedResults[k])
+                task->err = 1;
+        }
+    }
+}
+
+static int
+testRegexpShared(void) {
+    testRegexpSharedTask tasks[8];
+    xmlTaskGroup *group;
+    xmlRegexpPtr regexp;
+    int i, err = 0;
+
+    /* Multi-byte characters also exercise partially read sequences */
+    regexp = xmlRegexpCompile(BAD_CAST
+        "([a-z]|\xC3\xA9|\xE4\xB8\xAD|\xE6\x96\x87)+(-[0-9][0-9])*");
+    if (regexp == NULL) {
+        fprintf(stderr, "testRegexpShared: compilation failed\n");
+        return(1);
+    }
+
+    group = xmlNewTaskGroup();
+    for (i = 0; i < 8; i++) {
+        tasks[i].regexp = regexp;
+        tasks[i].err = 0;
+        if (xmlTaskGroupSubmit(group, testRegexpSharedRun, &tasks[i]) < 0)
+            testRegexpSharedRun(&tasks[i]);
+    }
+    xmlFreeTaskGroup(group);
+
+    for (i = 0; i < 8; i++) {
+        if (tasks[i].err) {
+            fprintf(stderr, "testRegexpShared: wrong result in task %d\n",
+                    i);
+            err = 1;
+        }
+    }
+
+    xmlRegFreeRegexp(regexp);
+    return(err);
+}
+
+static int
+testRegexpExecReset(void) {
+    xmlAutomataPtr am;
+    xmlAutomataStatePtr start, loop, end;
+    xmlRegexpPtr counted = NULL, plain = NULL;
+    xmlRegExecCtxtPtr exec = NULL;
+    int counter, err = 0;
+
+    /* a{2,3} built with a counter like content models */
+    am = xmlNewAutomata();
+    start = xmlAutomataGetInitState(am);
+    counter = xmlAutomataNewCounter(am, 1, 2);
+    loop = xmlAutomataNewState(am);
+    xmlAutomataNewEpsilon(am, start, loop);
+    end = xmlAutomataNewTransition(am, loop, NULL, BAD_CAST "a", NULL);
+    xmlAutomataNewCountedTrans(am, end, loop, counter);
+    end = xmlAutomataNewCounterTrans(am, end, NULL, counter);
+    xmlAutomataSetFinalState(am, end);
+    counted = xmlAutomataCompile(am);
+    xmlFreeAutomata(am);
+
+    /* x y doesn't */
+    am = xmlNewAutomata();
+    start = xmlAutomataGetInitState(am);
+    end = xmlAutomataNewTransition(am, start, NULL, BAD_CAST "x", NULL);
+    end = xmlAutomataNewTransition(am, end, NULL, BAD_CAST "y", NULL);
+    xmlAutomataSetFinalState(am, end);
+    plain = xmlAutomataCompile(am);
+    xmlFreeAutomata(am);
+
+    if ((counted == NULL) || (plain == NULL)) {
+        fprintf(stderr, "testRegexpExecReset: compilation failed\n");
+        err = 1;
+        goto done;
+    }
+
+    exec = xmlRegNewExecCtxt(plain, NULL, NULL);
+    if (exec == NULL) {
+        fprintf(stderr, "testRegexpExecReset: no context\n");
+        err = 1;
+        goto done;
+    }
+    /* Leave the first run unfinished */
+    xmlRegExecPushString(exec, BAD_CAST "x", NULL);
+
+    if ((xmlRegExecReset(exec, counted, NULL, NULL) != 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "a", NULL) < 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "a", NULL) < 0) ||
+        (xmlRegExecPushString(exec, NULL, NULL) != 1)) {
+        fprintf(stderr, "testRegexpExecReset: counted run failed\n");
+        err = 1;
+    }
+    if ((xmlRegExecReset(exec, counted, NULL, NULL) != 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "a", NULL) < 0) ||
+        (xmlRegExecPushString(exec, NULL, NULL) == 1)) {
+        fprintf(stderr, "testRegexpExecReset: counters not reset\n");
+        err = 1;
+    }
+    if ((xmlRegExecReset(exec, plain, NULL, NULL) != 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "x", NULL) < 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "y", NULL) < 0) ||
+        (xmlRegExecPushString(exec, NULL, NULL) != 1)) {
+        fprintf(stderr, "testRegexpExecReset: plain run failed\n");
+        err = 1;
+    }
+    if ((xmlRegExecReset(exec, counted, NULL, NULL) != 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "a", NULL) < 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "a", NULL) < 0) ||
+        (xmlRegExecPushString(exec, BAD_CAST "a", NULL) < 0) ||
+        ((xmlRegExecPushString(exec, BAD_CAST "a", NULL) >= 0) &&
+         (xmlRegExecPushString(exec, NULL, NULL) == 1))) {
+        fprintf(stderr, "testRegexpExecReset: too many a accepted\n");
+        err = 1;
+    }
+    if (xmlRegExecReset(exec, NULL, NULL, NULL) != -1) {
+        fprintf(stderr, "testRegexpExecReset: NULL regexp accepted\n");
+        err = 1;
+    }
+
+done:
+    xmlRegFreeExecCtxt(exec);
+    xmlRegFreeRegexp(counted);
+    xmlRegFreeRegexp(plain);
+    return(err);
+}
+#endif /* LIBXML_REGEXP_ENABLED */
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+static int
+testSchemaExecReuse(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:element name='doc'><xs:complexType><xs:sequence>\n"
+        "    <xs:element name='row' minOccurs='2' maxOccurs='50'>\n"
+        "      <xs:complexType><xs:choice maxOccurs='unbounded'>\n"
+        "        <xs:element name='a' type='xs:int'/>\n"
+        "        <xs:element name='b' type='xs:string'/>\n"
+        "      </xs:choice></xs:complexType>\n"
+        "    </xs:element>\n"
+        "  </xs:sequence></xs:complexType></xs:element>\n"
+        "</xs:schema>\n";
+    static const char *const rng =
+        "<element name='doc' xmlns='http://relaxng.org/ns/structure/1.0'>\n"
+        "  <oneOrMore><element name='row'><oneOrMore><choice>\n"
+        "    <element name='a'><text/></element>\n"
+        "    <element name='b'><text/></element>\n"
+        "  </choice></oneOrMore></element></oneOrMore>\n"
+        "</element>\n";
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema;
+    xmlSchemaValidCtxtPtr vctxt;
+    xmlBufferPtr valid, invalid;
+    xmlDocPtr docs[2];
+    int i, j, err = 0;
+
+    valid = xmlBufferCreate();
+    invalid = xmlBufferCreate();
+    xmlBufferCCat(valid, "<doc>");
+    xmlBufferCCat(invalid, "<doc>");
+    for (i = 0; i < 40; i++) {
+        xmlBufferCCat(valid, "<row><a>1</a><b>x</b><a>2</a></row>");
+        xmlBufferCCat(invalid, i == 30 ? "<row/>" :
+                               "<row><b>x</b><a>3</a></row>");
+    }
+    xmlBufferCCat(valid, "</doc>");
+    xmlBufferCCat(invalid, "</doc>");
+    docs[0] = xmlReadMemory((const char *) xmlBufferContent(valid),
+                            xmlBufferLength(valid), NULL, NULL, 0);
+    docs[1] = xmlReadMemory((const char *) xmlBufferContent(invalid),
+                            xmlBufferLength(invalid), NULL, NULL, 0);
+    xmlBufferFree(valid);
+    xmlBufferFree(invalid);
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    schema = xmlSchemaParse(pctxt);
+    xmlSchemaFreeParserCtxt(pctxt);
+    if ((schema == NULL) || (docs[0] == NULL) || (docs[1] == NULL)) {
+        fprintf(stderr, "testSchemaExecReuse: setup failed\n");
+        err = 1;
+        goto done;
+    }
+
+    /* The same contexts must give the same results on every run */
+    vctxt = xmlSchemaNewValidCtxt(schema);
+    xmlSchemaSetValidStructuredErrors(vctxt, ignoreError, NULL);
+    for (i = 0; i < 6; i++) {
+        j = i % 2;
+        if ((xmlSchemaValidateDoc(vctxt, docs[j]) == 0) != (j == 0)) {
+            fprintf(stderr, "testSchemaExecReuse: XSD run %d wrong\n", i);
+            err = 1;
+        }
+    }
+    xmlSchemaFreeValidCtxt(vctxt);
+
+#ifdef LIBXML_RELAXNG_ENABLED
+    {
+        xmlRelaxNGParserCtxtPtr rpctxt;
+        xmlRelaxNGPtr rschema;
+        xmlRelaxNGValidCtxtPtr rvctxt;
+
+        rpctxt = xmlRelaxNGNewMemParserCtxt(rng, strlen(rng));
+        rschema = xmlRelaxNGParse(rpctxt);
+        xmlRelaxNGFreeParserCtxt(rpctxt);
+        rvctxt = xmlRelaxNGNewValidCtxt(rschema);
+        xmlRelaxNGSetValidStructuredErrors(rvctxt, ignoreError, NULL);
+        for (i = 0; i < 6; i++) {
+            j = i % 2;
+            if ((xmlRelaxNGValidateDoc(rvctxt, docs[j]) == 0) != (j == 0)) {
+                fprintf(stderr, "testSchemaExecReuse: RNG run %d wrong\n",
+                        i);
+                err = 1;
+            }
+        }
+        xmlRelaxNGFreeValidCtxt(rvctxt);
+        xmlRelaxNGFree(rschema);
+    }
+#else
+    (void) rng;
+#endif
+
+done:
+    xmlSchemaFree(schema);
+    xmlFreeDoc(docs[0]);
+    xmlFreeDoc(docs[1]);
+    return(err);
+}
+
+/*
+ * Content models index the names of their transitions. Names that
+ * are prefixes of others or that only differ in their namespace must
+ * not be mixed up.
+ */
+static int
+testSchemaNameLookup(void) {
+    static const char *const docs[] = {
+        "<r xmlns='urn:t'><e0/><e7/><e19/><e10/><e1/><text/></r>",
+        "<r xmlns='urn:t'><e1/><e20/></r>",
+        "<r xmlns='urn:t'><e1/><e/></r>",
+        "<r xmlns='urn:t'><e1/><e10x/></r>",
+        "<r xmlns='urn:t'><e1/><e1 xmlns='urn:other'/></r>",
+        "<r xmlns='urn:t'><e1/><e1 xmlns=''/></r>",
+        "<r xmlns='urn:t'><e1/><text xmlns='urn:t2'/></r>",
+    };
+    xmlBufferPtr xsd, rng;
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema;
+    xmlSchemaValidCtxtPtr vctxt;
+    char name[20];
+    int i, ret, err = 0;
+
+    xsd = xmlBufferCreate();
+    rng = xmlBufferCreate();
+    xmlBufferCCat(xsd,
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'"
+        " targetNamespace='urn:t' elementFormDefault='qualified'>"
+        "<xs:element name='r'><xs:complexType>"
+        "<xs:choice maxOccurs='unbounded'>"
+        "<xs:element name='text'/>");
+    xmlBufferCCat(rng,
+        "<element name='r' ns='urn:t'"
+        " xmlns='http://relaxng.org/ns/structure/1.0'>"
+        "<oneOrMore><choice>"
+        "<element name='text'><empty/></element>");
+    for (i = 0; i < 20; i++) {
+        snprintf(name, sizeof(name), "e%d", i);
+        xmlBufferCCat(xsd, "<xs:element name='");
+        xmlBufferCCat(xsd, name);
+        xmlBufferCCat(xsd, "'/>");
+        xmlBufferCCat(rng, "<element name='");
+        xmlBufferCCat(rng, name);
+        xmlBufferCCat(rng, "'><empty/></element>");
+    }
+    xmlBufferCCat(xsd, "</xs:choice></xs:complexType></xs:element>"
+                       "</xs:schema>");
+    xmlBufferCCat(rng, "</choice></oneOrMore></element>");
+
+    pctxt = xmlSchemaNewMemParserCtxt((const char *) xmlBufferContent(xsd),
+                                      xmlBufferLength(xsd));
+    schema = xmlSchemaParse(pctxt);
+    xmlSchemaFreeParserCtxt(pctxt);
+    vctxt = xmlSchemaNewValidCtxt(schema);
+    xmlSchemaSetValidStructuredErrors(vctxt, ignoreError, NULL);
+
+    for (i = 0; i < (int) (sizeof(docs) / sizeof(docs[0])); i++) {
+        xmlDocPtr doc = xmlReadDoc(BAD_CAST docs[i], NULL, NULL, 0);
+
+        ret = xmlSchemaValidateDoc(vctxt, doc);
+        if ((ret == 0) != (i == 0)) {
+            fprintf(stderr, "testSchemaNameLookup: XSD doc %d got %d\n",
+                    i, ret);
+            err = 1;
+        }
+        xmlFreeDoc(doc);
+    }
+    xmlSchemaFreeValidCtxt(vctxt);
+    xmlSchemaFree(schema);
+
+#ifdef LIBXML_RELAXNG_ENABLED
+    {
+        xmlRelaxNGParserCtxtPtr rpctxt;
+        xmlRelaxNGPtr rschema;
+        xmlRelaxNGValidCtxtPtr rvctxt;
+
+        rpctxt = xmlRelaxNGNewMemParserCtxt(
+                (const char *) xmlBufferContent(rng), xmlBufferLength(rng));
+        rschema = xmlRelaxNGParse(rpctxt);
+        xmlRelaxNGFreeParserCtxt(rpctxt);
+        rvctxt = xmlRelaxNGNewValidCtxt(rschema);
+        xmlRelaxNGSetValidStructuredErrors(rvctxt, ignoreError, NULL);
+
+        for (i = 0; i < (int) (sizeof(docs) / sizeof(docs[0])); i++) {
+            xmlDocPtr doc = xmlReadDoc(BAD_CAST docs[i], NULL, NULL, 0);
+
+            ret = xmlRelaxNGValidateDoc(rvctxt, doc);
+            if ((ret == 0) != (i == 0)) {
+                fprintf(stderr, "testSchemaNameLookup: RNG doc %d got %d\n",
+                        i, ret);
+                err = 1;
+            }
+            xmlFreeDoc(doc);
+        }
+        xmlRelaxNGFreeValidCtxt(rvctxt);
+        xmlRelaxNGFree(rschema);
+    }
+#endif
+
+    xmlBufferFree(xsd);
+    xmlBufferFree(rng);
+    return(err);
+}
+
+/*
+ * Long namespace lists of wildcards are hashed. The absent namespace
+ * and namespaces that aren't listed must still be told apart.
+ */
+static int
+testSchemaWildcardNs(void) {
+    static const char *const docs[] = {
+        /* valid */
+        "<r xmlns='urn:t' xmlns:a='urn:a3' xmlns:b='urn:a9' a:x='1' y='2'>"
+        "<a:e/><b:f/><e xmlns=''/><name/><e xmlns='urn:a0'/></r>",
+        "<r xmlns='urn:t' b:x='1' xmlns:b='urn:a10'/>",
+        "<r xmlns='urn:t'><e xmlns='urn:b'/></r>",
+        "<r xmlns='urn:t'><e xmlns='urn:a'/></r>",
+        "<r xmlns='urn:t'><name xmlns='urn:a2'/><e xmlns='urn:t'/></r>",
+        "<r xmlns='urn:t' xmlns:b='urn:a' b:x='1'/>",
+    };
+    xmlBufferPtr xsd;
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema;
+    xmlSchemaValidCtxtPtr vctxt;
+    char ns[20];
+    int i, ret, err = 0;
+
+    xsd = xmlBufferCreate();
+    xmlBufferCCat(xsd,
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'"
+        " targetNamespace='urn:t' elementFormDefault='qualified'>"
+        "<xs:element name='r'><xs:complexType>"
+        "<xs:choice minOccurs='0' maxOccurs='unbounded'>"
+        "<xs:element name='name'/>"
+        "<xs:any processContents='skip' namespace='##local");
+    for (i = 0; i < 10; i++) {
+        snprintf(ns, sizeof(ns), " urn:a%d", i);
+        xmlBufferCCat(xsd, ns);
+    }
+    xmlBufferCCat(xsd,
+        "'/></xs:choice>"
+        "<xs:anyAttribute processContents='skip' namespace='##local");
+    for (i = 0; i < 12; i++) {
+        snprintf(ns, sizeof(ns), " urn:a%d", i);
+        xmlBufferCCat(xsd, ns);
+    }
+    xmlBufferCCat(xsd, "'/></xs:complexType></xs:element></xs:schema>");
+
+    pctxt = xmlSchemaNewMemParserCtxt((const char *) xmlBufferContent(xsd),
+                                      xmlBufferLength(xsd));
+    schema = xmlSchemaParse(pctxt);
+    xmlSchemaFreeParserCtxt(pctxt);
+    xmlBufferFree(xsd);
+    if (schema == NULL) {
+        fprintf(stderr, "testSchemaWildcardNs: schema failed\n");
+        return(1);
+    }
+    vctxt = xmlSchemaNewValidCtxt(schema);
+    xmlSchemaSetValidStructuredErrors(vctxt, ignoreError, NULL);
+
+    for (i = 0; i < (int) (sizeof(docs) / sizeof(docs[0])); i++) {
+        xmlDocPtr doc = xmlReadDoc(BAD_CAST docs[i], NULL, NULL, 0);
+
+        ret = xmlSchemaValidateDoc(vctxt, doc);
+        if ((ret == 0) != (i <= 1)) {
+            fprintf(stderr, "testSchemaWildcardNs: doc %d got %d\n",
+                    i, ret);
+            err = 1;
+        }
+        xmlFreeDoc(doc);
+    }
+    xmlSchemaFreeValidCtxt(vctxt);
+    xmlSchemaFree(schema);
+
+    return(err);
+}
+#endif /* LIBXML_SCHEMAS_ENABLED */
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+static int
+testSchemaSaveLoad(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:simpleType name='code'>\n"
+        "    <xs:restriction base='xs:string'>\n"
+        "      <xs:pattern value='[A-Z]{3}'/>\n"
+        "    </xs:restriction>\n"
+        "  </xs:simpleType>\n"
+        "  <xs:element name='doc'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='item' maxOccurs='unbounded'>\n"
+        "          <xs:complexType>\n"
+        "            <xs:all>\n"
+        "              <xs:element name='a' type='code'/>\n"
+        "              <xs:element name='b' type='xs:int' minOccurs='0'/>\n"
+        "            </xs:all>\n"
+        "            <xs:attribute name='id' type='xs:int' default='1'/>\n"
+        "          </xs:complexType>\n"
+        "        </xs:element>\n"
+        "      </xs:sequence>\n"
+        "    </xs:complexType>\n"
+        "    <xs:unique name='ids'>\n"
+        "      <xs:selector xpath='item'/>\n"
+        "      <xs:field xpath='@id'/>\n"
+        "    </xs:unique>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    static const struct {
+        const char *doc;
+        int valid;
+    } tests[] = {
+        { "<doc><item id='1'><b>2</b><a>ABC</a></item></doc>", 1 },
+        { "<doc><item id='1'><a>abc</a></item></doc>", 0 },
+        { "<doc><item><a>ABC</a></item><item><a>DEF</a></item></doc>", 0 },
+        { "<doc><item id='1'><b>2</b></item></doc>", 0 },
+    };
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL, loaded = NULL, bad;
+    xmlChar *mem = NULL;
+    int size, i, err = 0;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    if (pctxt != NULL) {
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+    if ((schema == NULL) ||
+        (xmlSchemaSaveMemory(schema, &mem, &size) < 0)) {
+        fprintf(stderr, "testSchemaSaveLoad: save failed\n");
+        err = 1;
+        goto done;
+    }
+    loaded = xmlSchemaLoadMemory((const char *) mem, size);
+    if (loaded == NULL) {
+        fprintf(stderr, "testSchemaSaveLoad: load failed\n");
+        err = 1;
+        goto done;
+    }
+
+    for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); i++) {
+        xmlSchemaValidCtxtPtr vctxt;
+        xmlDocPtr doc;
+        int ret;
+
+        doc = xmlReadDoc(BAD_CAST tests[i].doc, NULL, NULL, XML_PARSE_NOERROR);
+        vctxt = xmlSchemaNewValidCtxt(loaded);
+        xmlSchemaSetValidStructuredErrors(vctxt, ignoreError, NULL);
+        ret = xmlSchemaValidateDoc(vctxt, doc);
+        if ((ret == 0) != tests[i].valid) {
+            fprintf(stderr, "testSchemaSaveLoad: wrong result for %s\n",
+                    tests[i].doc);
+            err = 1;
+        }
+        xmlSchemaFreeValidCtxt(vctxt);
+        xmlFreeDoc(doc);
+    }
+
+    /* Truncated input is rejected */
+    for (i = 0; i < size; i++) {
+        bad = xmlSchemaLoadMemory((const char *) mem, i);
+        if (bad != NULL) {
+            fprintf(stderr, "testSchemaSaveLoad: loaded %d bytes\n", i);
+            xmlSchemaFree(bad);
+            err = 1;
+            break;
+        }
+    }
+
+done:
+    xmlFree(mem);
+    xmlSchemaFree(loaded);
+    xmlSchemaFree(schema);
+    return(err);
+}
+
+static void
+testSchemaValidCtxtPoolError(void *vctxt, const xmlError *error ATTRIBUTE_UNUSED) {
+    int *count = vctxt;
+
+    *count += 1;
+}
+
+static int
+testSchemaValidCtxtPool(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:element name='doc'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='item' maxOccurs='unbounded'>\n"
+        "          <xs:complexType>\n"
+        "            <xs:attribute name='id' type='xs:int'/>\n"
+        "            <xs:attribute name='ref' type='xs:int'/>\n"
+        "          </xs:complexType>\n"
+        "        </xs:element>\n"
+        "      </xs:sequence>\n"
+        "    </xs:complexType>\n"
+        "    <xs:key name='ids'>\n"
+        "      <xs:selector xpath='item'/>\n"
+        "      <xs:field xpath='@id'/>\n"
+        "    </xs:key>\n"
+        "    <xs:keyref name='refs' refer='ids'>\n"
+        "      <xs:selector xpath='item'/>\n"
+        "      <xs:field xpath='@ref'/>\n"
+        "    </xs:keyref>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    const char *good =
+        "<doc><item id='1'/><item id='2' ref='1'/><item id='3' ref='2'/>"
+        "</doc>";
+    const char *bad = "<doc><item id='1'/><item id='1'/></doc>";
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL;
+    xmlSchemaValidCtxtPool *pool = NULL;
+    xmlSchemaValidCtxtPtr vctxt, vctxt2;
+    xmlDocPtr goodDoc, badDoc;
+    int errors = 0;
+    int i, ret;
+    int err = 0;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    if (pctxt != NULL) {
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+    if (schema != NULL)
+        pool = xmlSchemaNewValidCtxtPool(schema, 1);
+    if (pool == NULL) {
+        fprintf(stderr, "testSchemaValidCtxtPool: creating pool failed\n");
+        xmlSchemaFree(schema);
+        return(1);
+    }
+    goodDoc = xmlReadDoc(BAD_CAST good, NULL, NULL, 0);
+    badDoc = xmlReadDoc(BAD_CAST bad, NULL, NULL, 0);
+
+    vctxt = xmlSchemaValidCtxtPoolAcquire(pool);
+    xmlSchemaSetValidStructuredErrors(vctxt, testSchemaValidCtxtPoolError,
+                                      &errors);
+    xmlSchemaSetValidOptions(vctxt, XML_SCHEMA_VAL_VC_I_CREATE);
+    if ((xmlSchemaValidateDoc(vctxt, badDoc) <= 0) || (errors == 0)) {
+        fprintf(stderr, "testSchemaValidCtxtPool: invalid doc accepted\n");
+        err = 1;
+    }
+    xmlSchemaValidCtxtPoolRelease(pool, vctxt);
+
+    for (i = 0; i < 3; i++) {
+        vctxt2 = xmlSchemaValidCtxtPoolAcquire(pool);
+        if (vctxt2 != vctxt) {
+            fprintf(stderr, "testSchemaValidCtxtPool: context wasn't "
+                    "reused\n");
+            err = 1;
+        }
+        if ((xmlSchemaValidCtxtGetOptions(vctxt2) != 0) ||
+            (xmlSchemaIsValid(vctxt2) != 1)) {
+            fprintf(stderr, "testSchemaValidCtxtPool: context wasn't "
+                    "reset\n");
+            err = 1;
+        }
+
+        if (xmlSchemaValidateDoc(vctxt2, goodDoc) != 0) {
+            fprintf(stderr, "testSchemaValidCtxtPool: valid doc "
+                    "rejected\n");
+            err = 1;
+        }
+
+        /* The error handler must have been cleared */
+        errors = 0;
+        xmlSetStructuredErrorFunc(NULL, ignoreError);
+        ret = xmlSchemaValidateDoc(vctxt2, badDoc);
+        xmlSetStructuredErrorFunc(NULL, NULL);
+        if ((ret <= 0) || (errors != 0)) {
+            fprintf(stderr, "testSchemaValidCtxtPool: unexpected "
+                    "result\n");
+            err = 1;
+        }
+
+        xmlSchemaValidCtxtPoolRelease(pool, vctxt2);
+    }
+
+    /* The pool is full, so this context is freed */
+    vctxt = xmlSchemaValidCtxtPoolAcquire(pool);
+    vctxt2 = xmlSchemaValidCtxtPoolAcquire(pool);
+    xmlSchemaValidCtxtPoolRelease(pool, vctxt);
+    xmlSchemaValidCtxtPoolRelease(pool, vctxt2);
+
+    xmlFreeDoc(goodDoc);
+    xmlFreeDoc(badDoc);
+    xmlSchemaFreeValidCtxtPool(pool);
+    xmlSchemaFree(schema);
+
+    return(err);
+}
+
+static int
+testSchemaProfile(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:element name='doc'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='item' maxOccurs='unbounded'>\n"
+        "          <xs:complexType>\n"
+        "            <xs:simpleContent>\n"
+        "              <xs:extension base='xs:decimal'>\n"
+        "                <xs:attribute name='id' type='xs:int'/>\n"
+        "                <xs:anyAttribute processContents='skip'/>\n"
+        "              </xs:extension>\n"
+        "            </xs:simpleContent>\n"
+        "          </xs:complexType>\n"
+        "        </xs:element>\n"
+        "        <xs:any namespace='##other' processContents='skip'\n"
+        "                minOccurs='0'/>\n"
+        "      </xs:sequence>\n"
+        "    </xs:complexType>\n"
+        "    <xs:key name='ids'>\n"
+        "      <xs:selector xpath='item'/>\n"
+        "      <xs:field xpath='@id'/>\n"
+        "    </xs:key>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    const char *xml =
+        "<doc><item id='1' x='a'>1.5</item><item id='2'>2</item>"
+        "<item id='3'>3</item><o xmlns='urn:o'/></doc>";
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL;
+    xmlSchemaValidCtxtPtr vctxt;
+    xmlSchemaValidStats stats;
+    xmlDocPtr doc;
+    int err = 0;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    if (pctxt != NULL) {
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+    if (schema == NULL) {
+        fprintf(stderr, "testSchemaProfile: parsing schema failed\n");
+        return(1);
+    }
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    vctxt = xmlSchemaNewValidCtxt(schema);
+
+    if (xmlSchemaValidCtxtGetStats(vctxt, &stats) != -1) {
+        fprintf(stderr, "testSchemaProfile: got stats without profile\n");
+        err = 1;
+    }
+    xmlSchemaValidCtxtSetProfile(vctxt, 1);
+    if (xmlSchemaValidateDoc(vctxt, doc) != 0) {
+        fprintf(stderr, "testSchemaProfile: validation failed\n");
+        err = 1;
+    }
+    if ((xmlSchemaValidCtxtGetStats(vctxt, &stats) != 0) ||
+        (stats.elements != 4) ||
+        (stats.attributes != 3) ||
+        (stats.simpleChecks != 6) ||
+        (stats.automatonPushes != 5) ||
+        (stats.idcEvaluations != 7) ||
+        (stats.wildcards != 2)) {
+        fprintf(stderr, "testSchemaProfile: unexpected counters: "
+                "%lu %lu %lu %lu %lu %lu\n",
+                stats.elements, stats.attributes, stats.simpleChecks,
+                stats.automatonPushes, stats.idcEvaluations,
+                stats.wildcards);
+        err = 1;
+    }
+
+    /* Counters accumulate over runs */
+    xmlSchemaValidateDoc(vctxt, doc);
+    xmlSchemaValidCtxtGetStats(vctxt, &stats);
+    if (stats.elements != 8) {
+        fprintf(stderr, "testSchemaProfile: counters not accumulated\n");
+        err = 1;
+    }
+
+    xmlSchemaFreeValidCtxt(vctxt);
+    xmlFreeDoc(doc);
+    xmlSchemaFree(schema);
+
+    return(err);
+}
+
+static int
+testSchemaValues(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:simpleType name='color'>\n"
+        "    <xs:restriction base='xs:token'>\n"
+        "      <xs:enumeration value='red'/>\n"
+        "      <xs:enumeration value='dark blue'/>\n"
+        "    </xs:restriction>\n"
+        "  </xs:simpleType>\n"
+        "  <xs:element name='doc'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='price' type='xs:decimal'/>\n"
+        "        <xs:element name='when' type='xs:dateTime'/>\n"
+        "        <xs:element name='color' type='color'/>\n"
+        "      </xs:sequence>\n"
+        "      <xs:attribute name='n' type='xs:int'/>\n"
+        "    </xs:complexType>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    const char *xml =
+        "<doc n='+007'><price>0012.50</price>"
+        "<when>2024-01-02T03:04:05Z</when>"
+        "<color> dark   blue </color></doc>";
+    static const char *const canons[] = {
+        "7", "12.5", "2024-01-02T03:04:05Z", "dark blue"
+    };
+    static const char *const names[] = { "n", "price", "when", "color" };
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL;
+    xmlSchemaValidCtxtPtr vctxt;
+    const xmlSchemaNodeValue *values;
+    xmlDocPtr doc;
+    int i, n, err = 0;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    if (pctxt != NULL) {
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+    if (schema == NULL) {
+        fprintf(stderr, "testSchemaValues: parsing schema failed\n");
+        return(1);
+    }
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    vctxt = xmlSchemaNewValidCtxt(schema);
+
+    xmlSchemaValidateDoc(vctxt, doc);
+    if (xmlSchemaValidCtxtGetValues(vctxt, &values) != 0) {
+        fprintf(stderr, "testSchemaValues: values kept by default\n");
+        err = 1;
+    }
+
+    xmlSchemaValidCtxtKeepValues(vctxt, 1);
+    if (xmlSchemaValidateDoc(vctxt, doc) != 0) {
+        fprintf(stderr, "testSchemaValues: validation failed\n");
+        err = 1;
+    }
+    n = xmlSchemaValidCtxtGetValues(vctxt, &values);
+    if (n != 4) {
+        fprintf(stderr, "testSchemaValues: got %d values\n", n);
+        err = 1;
+        n = 0;
+    }
+    for (i = 0; i < n; i++) {
+        const xmlChar *canon = xmlSchemaValueGetCanon(values[i].value);
+        xmlChar *copy = NULL;
+
+        if ((values[i].node == NULL) ||
+            (!xmlStrEqual(values[i].node->name, BAD_CAST names[i])) ||
+            (!xmlStrEqual(canon, BAD_CAST canons[i]))) {
+            fprintf(stderr, "testSchemaValues: unexpected value %d: %s\n",
+                    i, (const char *) canon);
+            err = 1;
+        }
+        if (xmlSchemaValueGetCanon(values[i].value) != canon) {
+            fprintf(stderr, "testSchemaValues: canon not cached\n");
+            err = 1;
+        }
+        if ((xmlSchemaGetCanonValue(values[i].value,
+                                    (const xmlChar **) &copy) != 0) ||
+            (!xmlStrEqual(copy, canon))) {
+            fprintf(stderr, "testSchemaValues: GetCanonValue failed\n");
+            err = 1;
+        }
+        xmlFree(copy);
+    }
+
+    /* Values are replaced by the next run */
+    xmlSchemaValidateDoc(vctxt, doc);
+    if (xmlSchemaValidCtxtGetValues(vctxt, &values) != 4) {
+        fprintf(stderr, "testSchemaValues: values not reset\n");
+        err = 1;
+    }
+
+    xmlSchemaFreeValidCtxt(vctxt);
+    xmlFreeDoc(doc);
+    xmlSchemaFree(schema);
+
+    return(err);
+}
+
+static void
+testSchemaRevalidateError(void *data, const xmlError *error ATTRIBUTE_UNUSED) {
+    int *nbErrors = data;
+
+    *nbErrors += 1;
+}
+
+static int
+testSchemaRevalidate(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:element name='doc'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='rec' maxOccurs='unbounded'>\n"
+        "          <xs:complexType>\n"
+        "            <xs:sequence>\n"
+        "              <xs:element name='a' type='xs:int'/>\n"
+        "              <xs:element name='b' type='xs:string'/>\n"
+        "            </xs:sequence>\n"
+        "          </xs:complexType>\n"
+        "        </xs:element>\n"
+        "      </xs:sequence>\n"
+        "    </xs:complexType>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    const char *xml =
+        "<doc><rec><a>1</a><b>x</b></rec><rec><a>2</a><b>y</b></rec>"
+        "<rec><a>3</a><b>z</b></rec></doc>";
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL;
+    xmlSchemaValidCtxtPtr vctxt;
+    xmlSchemaValidStats stats;
+    xmlDocPtr doc;
+    xmlNodePtr rec2, rec3, text, a;
+    int nbErrors = 0;
+    int err = 0;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    if (pctxt != NULL) {
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+    if (schema == NULL) {
+        fprintf(stderr, "testSchemaRevalidate: parsing schema failed\n");
+        return(1);
+    }
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    rec2 = xmlDocGetRootElement(doc)->children->next;
+    rec3 = rec2->next;
+    text = rec2->children->children;
+    vctxt = xmlSchemaNewValidCtxt(schema);
+    xmlSchemaSetValidStructuredErrors(vctxt, testSchemaRevalidateError,
+                                      &nbErrors);
+    xmlSchemaValidCtxtSetProfile(vctxt, 1);
+
+    if (xmlSchemaValidateDoc(vctxt, doc) != 0) {
+        fprintf(stderr, "testSchemaRevalidate: validation failed\n");
+        err = 1;
+    }
+
+    /* Only the path to the modified node is validated */
+    xmlNodeSetContent(text, BAD_CAST "two");
+    xmlSchemaValidCtxtSetProfile(vctxt, 1);
+    if ((xmlSchemaRevalidateDoc(vctxt, doc, &text, 1) <= 0) ||
+        (nbErrors != 1)) {
+        fprintf(stderr, "testSchemaRevalidate: invalid value not found\n");
+        err = 1;
+    }
+    if ((xmlSchemaValidCtxtGetStats(vctxt, &stats) != 0) ||
+        (stats.elements != 3)) {
+        fprintf(stderr, "testSchemaRevalidate: unexpected elements: %lu\n",
+                stats.elements);
+        err = 1;
+    }
+
+    xmlNodeSetContent(text, BAD_CAST "2");
+    if (xmlSchemaRevalidateDoc(vctxt, doc, &text, 1) != 0) {
+        fprintf(stderr, "testSchemaRevalidate: fixed value not valid\n");
+        err = 1;
+    }
+
+    /* Content models of modified elements are checked */
+    nbErrors = 0;
+    a = rec3->children;
+    xmlUnlinkNode(a);
+    xmlAddChild(rec3, a);
+    if ((xmlSchemaRevalidateDoc(vctxt, doc, &rec3, 1) <= 0) ||
+        (nbErrors == 0)) {
+        fprintf(stderr, "testSchemaRevalidate: wrong order not found\n");
+        err = 1;
+    }
+
+    xmlSchemaFreeValidCtxt(vctxt);
+    xmlFreeDoc(doc);
+    xmlSchemaFree(schema);
+
+    return(err);
+}
+
+typedef struct {
+    const char *name;
+    const char *content;
+    int loaded;
+} testSchemaLazyDoc;
+
+static xmlParserErrors
+testSchemaLazyLoader(void *vctxt, const char *url,
+                     const char *publicId ATTRIBUTE_UNUSED,
+                     xmlResourceType type ATTRIBUTE_UNUSED,
+                     xmlParserInputFlags flags ATTRIBUTE_UNUSED,
+                     xmlParserInputPtr *out) {
+    testSchemaLazyDoc *docs = vctxt;
+    int i;
+
+    for (i = 0; docs[i].name != NULL; i++) {
+        if (strcmp(url, docs[i].name) == 0) {
+            docs[i].loaded += 1;
+            *out = xmlNewInputFromString(url, docs[i].content,
+                                         XML_INPUT_BUF_STATIC);
+            return(*out != NULL ? XML_ERR_OK : XML_ERR_NO_MEMORY);
+        }
+    }
+
+    *out = NULL;
+    return(XML_IO_ENOENT);
+}
+
+static int
+testSchemaLazyImports(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'\n"
+        "           xmlns:b='urn:b' targetNamespace='urn:a'\n"
+        "           elementFormDefault='qualified'>\n"
+        "  <xs:import namespace='urn:b' schemaLocation='test:b.xsd'/>\n"
+        "  <xs:import namespace='urn:c' schemaLocation='test:c.xsd'/>\n"
+        "  <xs:import namespace='urn:d' schemaLocation='test:d.xsd'/>\n"
+        "  <xs:element name='doc'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='num' type='b:num'/>\n"
+        "        <xs:any namespace='##other' processContents='lax'\n"
+        "                maxOccurs='unbounded'/>\n"
+        "      </xs:sequence>\n"
+        "    </xs:complexType>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    testSchemaLazyDoc docs[] = {
+        { "test:b.xsd",
+          "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'"
+          " targetNamespace='urn:b'>"
+          "<xs:simpleType name='num'>"
+          "<xs:restriction base='xs:int'/>"
+          "</xs:simpleType>"
+          "</xs:schema>", 0 },
+        { "test:c.xsd",
+          "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'"
+          " targetNamespace='urn:c'>"
+          "<xs:element name='c' type='xs:int'/>"
+          "</xs:schema>", 0 },
+        { "test:d.xsd",
+          "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'"
+          " targetNamespace='urn:d'>"
+          "<xs:element name='d' type='xs:int'/>"
+          "</xs:schema>", 0 },
+        { NULL, NULL, 0 }
+    };
+    const char *valid =
+        "<doc xmlns='urn:a'><num>1</num><c xmlns='urn:c'>2</c></doc>";
+    const char *invalid =
+        "<doc xmlns='urn:a'><num>1</num><c xmlns='urn:c'>x</c></doc>";
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL;
+    xmlSchemaValidCtxtPtr vctxt;
+    xmlDocPtr doc;
+    int nbErrors = 0;
+    int err = 0;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    if (pctxt != NULL) {
+        xmlSchemaSetResourceLoader(pctxt, testSchemaLazyLoader, docs);
+        xmlSchemaSetParserLazyImports(pctxt, 1);
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+    if (schema == NULL) {
+        fprintf(stderr, "testSchemaLazyImports: parsing schema failed\n");
+        return(1);
+    }
+
+    /* Only referenced namespaces are loaded when parsing */
+    if ((docs[0].loaded != 1) || (docs[1].loaded != 0) ||
+        (docs[2].loaded != 0)) {
+        fprintf(stderr, "testSchemaLazyImports: unexpected loads\n");
+        err = 1;
+    }
+
+    vctxt = xmlSchemaNewValidCtxt(schema);
+    xmlSchemaSetValidStructuredErrors(vctxt, testSchemaRevalidateError,
+                                      &nbErrors);
+
+    doc = xmlReadDoc(BAD_CAST valid, NULL, NULL, 0);
+    if (xmlSchemaValidateDoc(vctxt, doc) != 0) {
+        fprintf(stderr, "testSchemaLazyImports: validation failed\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+    if ((docs[1].loaded != 1) || (docs[2].loaded != 0)) {
+        fprintf(stderr, "testSchemaLazyImports: import not loaded\n");
+        err = 1;
+    }
+
+    /* Components of lazily loaded imports are used */
+    doc = xmlReadDoc(BAD_CAST invalid, NULL, NULL, 0);
+    if ((xmlSchemaValidateDoc(vctxt, doc) <= 0) || (nbErrors != 1)) {
+        fprintf(stderr, "testSchemaLazyImports: invalid value not found\n");
+        err = 1;
+    }
+    xmlFreeDoc(doc);
+    if (docs[1].loaded != 1) {
+        fprintf(stderr, "testSchemaLazyImports: import loaded twice\n");
+        err = 1;
+    }
+
+    xmlSchemaFreeValidCtxt(vctxt);
+    xmlSchemaFree(schema);
+
+    return(err);
+}
+
+static xmlSchemaPtr
+testSchemaParseThreadsParse(const char *url, int nbThreads, int *nbErrors) {
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL;
+
+    pctxt = xmlSchemaNewParserCtxt(url);
+    if (pctxt != NULL) {
+        xmlSchemaSetParserStructuredErrors(pctxt, testSchemaRevalidateError,
+                                           nbErrors);
+        xmlSchemaSetParserThreads(pctxt, nbThreads);
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+
+    return(schema);
+}
+
+static int
+testSchemaParseThreads(void) {
+    xmlSchemaPtr schema;
+    xmlSchemaValidCtxtPtr vctxt;
+    xmlDocPtr doc;
+    int nbErrors = 0, nbThreadErrors = 0;
+    int err = 0;
+
+    /* Imports and includes are parsed ahead */
+    schema = testSchemaParseThreadsParse("test/schemas/582906-1_0.xsd", 4,
+                                         &nbThreadErrors);
+    if ((schema == NULL) || (nbThreadErrors != 0)) {
+        fprintf(stderr, "testSchemaParseThreads: parsing schema failed\n");
+        err = 1;
+    } else {
+        doc = xmlReadFile("test/schemas/582906-1_0.xml", NULL, 0);
+        vctxt = xmlSchemaNewValidCtxt(schema);
+        if (xmlSchemaValidateDoc(vctxt, doc) != 0) {
+            fprintf(stderr, "testSchemaParseThreads: validation failed\n");
+            err = 1;
+        }
+        xmlSchemaFreeValidCtxt(vctxt);
+        xmlFreeDoc(doc);
+    }
+    xmlSchemaFree(schema);
+
+    /* Errors in documents parsed ahead are still reported */
+    nbThreadErrors = 0;
+    schema = testSchemaParseThreadsParse("test/schemas/582906-2_0.xsd", 4,
+                                         &nbThreadErrors);
+    xmlSchemaFree(schema);
+    schema = testSchemaParseThreadsParse("test/schemas/582906-2_0.xsd", 0,
+                                         &nbErrors);
+    xmlSchemaFree(schema);
+    if ((nbErrors == 0) || (nbThreadErrors != nbErrors)) {
+        fprintf(stderr, "testSchemaParseThreads: got %d errors, "
+                "expected %d\n", nbThreadErrors, nbErrors);
+        err = 1;
+    }
+
+    return(err);
+}
+
+typedef struct {
+    char buf[10000];
+    size_t len;
+} testSchemaParallelLog;
+
+static void
+testSchemaParallelError(void *data, const xmlError *error) {
+    testSchemaParallelLog *log = data;
+    int res;
+
+    res = snprintf(log->buf + log->len, sizeof(log->buf) - log->len,
+                   "%d:%d:%s", error->line, error->code, error->message);
+    if (res > 0)
+        log->len += res;
+    if (log->len >= sizeof(log->buf))
+        log->len = sizeof(log->buf) - 1;
+}
+
+static int
+testSchemaParallelValidate(xmlSchemaPtr schema, xmlDocPtr doc,
+                           int nbThreads, testSchemaParallelLog *log) {
+    xmlSchemaValidCtxtPtr vctxt;
+    int ret;
+
+    log->len = 0;
+    log->buf[0] = 0;
+    vctxt = xmlSchemaNewValidCtxt(schema);
+    if (vctxt == NULL)
+        return(-2);
+    xmlSchemaSetValidStructuredErrors(vctxt, testSchemaParallelError, log);
+    if ((nbThreads > 1) &&
+        (xmlSchemaValidCtxtSetParallel(vctxt, nbThreads, 10) < 0)) {
+        xmlSchemaFreeValidCtxt(vctxt);
+        return(-3);
+    }
+    ret = xmlSchemaValidateDoc(vctxt, doc);
+    xmlSchemaFreeValidCtxt(vctxt);
+
+    return(ret);
+}
+
+static int
+testSchemaParallel(void) {
+    const char *xsd =
+        "<xs:schema xmlns:xs='http://www.w3.org/2001/XMLSchema'>\n"
+        "  <xs:element name='doc'>\n"
+        "    <xs:complexType>\n"
+        "      <xs:sequence>\n"
+        "        <xs:element name='record' maxOccurs='unbounded'>\n"
+        "          <xs:complexType>\n"
+        "            <xs:sequence>\n"
+        "              <xs:element name='field' maxOccurs='unbounded'>\n"
+        "                <xs:complexType>\n"
+        "                  <xs:attribute name='id' type='xs:ID'/>\n"
+        "                  <xs:attribute name='n' type='xs:int'/>\n"
+        "                  <xs:attribute name='ref' type='xs:int'/>\n"
+        "                </xs:complexType>\n"
+        "              </xs:element>\n"
+        "            </xs:sequence>\n"
+        "          </xs:complexType>\n"
+        "          <xs:key name='ns'>\n"
+        "            <xs:selector xpath='field'/>\n"
+        "            <xs:field xpath='@n'/>\n"
+        "          </xs:key>\n"
+        "          <xs:keyref name='refs' refer='ns'>\n"
+        "            <xs:selector xpath='field'/>\n"
+        "            <xs:field xpath='@ref'/>\n"
+        "          </xs:keyref>\n"
+        "        </xs:element>\n"
+        "      </xs:sequence>\n"
+        "    </xs:complexType>\n"
+        "  </xs:element>\n"
+        "</xs:schema>\n";
+    static char xml[200000];
+    testSchemaParallelLog seqLog, parLog;
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaPtr schema = NULL;
+    xmlDocPtr doc;
+    size_t len = 0;
+    int i, j, seqRet, parRet;
+    int err = 0;
+
+    pctxt = xmlSchemaNewMemParserCtxt(xsd, strlen(xsd));
+    if (pctxt != NULL) {
+        schema = xmlSchemaParse(pctxt);
+        xmlSchemaFreeParserCtxt(pctxt);
+    }
+    if (schema == NULL) {
+        fprintf(stderr, "testSchemaParallel: parsing schema failed\n");
+        return(1);
+    }
+
+    /*
+     * Errors in the main part and in several records, including
+     * duplicate IDs within a record.
+     */
+    len += snprintf(xml + len, sizeof(xml) - len, "<doc>\n");
+    for (i = 0; i < 40; i++) {
+        len += snprintf(xml + len, sizeof(xml) - len, "<record>\n");
+        for (j = 0; j < 30; j++) {
+            const char *n = "%d";
+            int ref = j > 0 ? j - 1 : 0;
+
+            if ((i == 5) && (j == 7))
+                n = "x%d";
+            if ((i == 10) && (j == 3))
+                ref = 100;
+            len += snprintf(xml + len, sizeof(xml) - len,
+                            "<field id='r%d-%d' ", i,
+                            ((i == 33) && (j == 20)) ? 19 : j);
+            len += snprintf(xml + len, sizeof(xml) - len, "n='");
+            len += snprintf(xml + len, sizeof(xml) - len, n,
+                            ((i == 12) && (j == 9)) ? 8 : j);
+            len += snprintf(xml + len, sizeof(xml) - len,
+                            "' ref='%d'/>\n", ref);
+        }
+        if (i == 30)
+            len += snprintf(xml + len, sizeof(xml) - len, "<extra/>\n");
+        len += snprintf(xml + len, sizeof(xml) - len, "</record>\n");
+    }
+    len += snprintf(xml + len, sizeof(xml) - len, "<trailer/>\n</doc>\n");
+
+    doc = xmlReadMemory(xml, len, "parallel.xml", NULL, 0);
+    seqRet = testSchemaParallelValidate(schema, doc, 1, &seqLog);
+    xmlFreeDoc(doc);
+    doc = xmlReadMemory(xml, len, "parallel.xml", NULL, 0);
+    parRet = testSchemaParallelValidate(schema, doc, 4, &parLog);
+    xmlFreeDoc(doc);
+
+    if (parRet != -3) {
+        if ((seqRet <= 0) || (parRet != seqRet)) {
+            fprintf(stderr, "testSchemaParallel: results differ: %d %d\n",
+                    seqRet, parRet);
+            err = 1;
+        } else if (strcmp(seqLog.buf, parLog.buf) != 0) {
+            fprintf(stderr, "testSchemaParallel: errors differ:\n%s---\n%s",
+                    seqLog.buf, parLog.buf);
+            err = 1;
+        }
+    }
+
+    xmlSchemaFree(schema);
+    return(err);
+}
+#endif /* LIBXML_SCHEMAS_ENABLED */
+
+#ifdef LIBXML_RELAXNG_ENABLED
+static void
+testRelaxNGDerivativesError(void *data,
+                            const xmlError *error ATTRIBUTE_UNUSED) {
+    int *nbErrors = data;
+
+    *nbErrors += 1;
+}
+
+static int
+testRelaxNGDerivativesValidate(xmlRelaxNGPtr schema, const char *xml,
+                               int derivatives, int *nbErrors) {
+    xmlRelaxNGValidCtxtPtr vctxt;
+    xmlDocPtr doc;
+    int ret;
+
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    vctxt = xmlRelaxNGNewValidCtxt(schema);
+    xmlRelaxNGSetValidStructuredErrors(vctxt, testRelaxNGDerivativesError,
+                                       nbErrors);
+    xmlRelaxNGSetValidDerivatives(vctxt, derivatives);
+    ret = xmlRelaxNGValidateDoc(vctxt, doc);
+    xmlRelaxNGFreeValidCtxt(vctxt);
+    xmlFreeDoc(doc);
 
-    return err;
+    return(ret);
 }
-#endif
-#endif
 
-#ifdef LIBXML_WRITER_ENABLED
 static int
-testWriterIOWrite(void *ctxt, const char *data, int len) {
-    (void) ctxt;
-    (void) data;
+testRelaxNGDerivatives(void) {
+    const char *rng =
+        "<element name='doc' xmlns='http://relaxng.org/ns/structure/1.0'\n"
+        "  datatypeLibrary='http://www.w3.org/2001/XMLSchema-datatypes'>\n"
+        "  <interleave>\n"
+        "    <optional><attribute name='id'><data type='int'/>"
+        "</attribute></optional>\n"
+        "    <zeroOrMore><element name='a'><empty/></element></zeroOrMore>\n"
+        "    <oneOrMore><element name='b'><text/></element></oneOrMore>\n"
+        "    <optional><element name='c'><data type='int'/></element>"
+        "</optional>\n"
+        "    <zeroOrMore><choice><element name='d'><empty/></element>"
+        "<element name='e'><empty/></element></choice></zeroOrMore>\n"
+        "  </interleave>\n"
+        "</element>\n";
+    static const char *const docs[] = {
+        "<doc id='1'><a/><b>x</b><d/><a/><c>2</c><e/><b/></doc>",
+        "<doc><b/><a/><a/><b/><d/><d/><e/></doc>",
+        /* missing b */
+        "<doc><a/><c>1</c></doc>",
+        /* c appears twice */
+        "<doc><c>1</c><b/><c>2</c></doc>",
+        /* invalid int value */
+        "<doc><b/><c>x</c></doc>",
+        /* invalid attribute */
+        "<doc id='x'><b/></doc>",
+        /* text not allowed */
+        "<doc><b/>text<a/></doc>",
+    };
+    xmlRelaxNGParserCtxtPtr pctxt;
+    xmlRelaxNGPtr schema;
+    size_t i;
+    int err = 0;
 
-    return len;
+    pctxt = xmlRelaxNGNewMemParserCtxt(rng, strlen(rng));
+    schema = xmlRelaxNGParse(pctxt);
+    xmlRelaxNGFreeParserCtxt(pctxt);
+    if (schema == NULL) {
+        fprintf(stderr, "testRelaxNGDerivatives: parsing schema failed\n");
+        return(1);
+    }
+
+    /* Both engines agree on validity */
+    for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i++) {
+        int nbErrors = 0, nbDerivErrors = 0;
+        int ret, derivRet;
+
+        ret = testRelaxNGDerivativesValidate(schema, docs[i], 0, &nbErrors);
+        derivRet = testRelaxNGDerivativesValidate(schema, docs[i], 1,
+                                                  &nbDerivErrors);
+        if ((ret != derivRet) || ((ret == 0) != (i < 2)) ||
+            ((nbErrors == 0) != (nbDerivErrors == 0))) {
+            fprintf(stderr, "testRelaxNGDerivatives: doc %d: got %d, "
+                    "expected %d\n", (int) i, derivRet, ret);
+            err = 1;
+        }
+    }
+
+    xmlRelaxNGFree(schema);
+    return(err);
 }
 
 static int
-testWriterIOClose(void *ctxt) {
-    (void) ctxt;
+testRelaxNGSaveLoad(void) {
+    const char *rng =
+        "<element name='doc' xmlns='http://relaxng.org/ns/structure/1.0'\n"
+        "  datatypeLibrary='http://www.w3.org/2001/XMLSchema-datatypes'>\n"
+        "  <attribute name='id'><data type='ID'/></attribute>\n"
+        "  <oneOrMore>\n"
+        "    <choice>\n"
+        "      <element name='item'>\n"
+        "        <attribute name='ref'><data type='IDREF'/></attribute>\n"
+        "        <interleave>\n"
+        "          <element name='a'><data type='string'>"
+        "<param name='pattern'>[A-Z]{3}</param></data></element>\n"
+        "          <optional><element name='b'><value type='int'>"
+        "007</value></element></optional>\n"
+        "        </interleave>\n"
+        "      </element>\n"
+        "      <element name='note'><text/></element>\n"
+        "    </choice>\n"
+        "  </oneOrMore>\n"
+        "</element>\n";
+    static const struct {
+        const char *doc;
+        int valid;
+    } tests[] = {
+        { "<doc id='d'><note/><item ref='d'><b>7</b><a>ABC</a></item></doc>",
+          1 },
+        { "<doc id='d'><item ref='d'><a>abc</a></item></doc>", 0 },
+        { "<doc id='d'><item ref='d'><a>ABC</a><b>8</b></item></doc>", 0 },
+        { "<doc id='d'><item ref='d'><b>7</b></item></doc>", 0 },
+    };
+    xmlRelaxNGParserCtxtPtr pctxt;
+    xmlRelaxNGPtr schema = NULL, loaded = NULL, bad;
+    xmlChar *mem = NULL;
+    int size, i, err = 0;
+
+    pctxt = xmlRelaxNGNewMemParserCtxt(rng, strlen(rng));
+    schema = xmlRelaxNGParse(pctxt);
+    xmlRelaxNGFreeParserCtxt(pctxt);
+    if ((schema == NULL) ||
+        (xmlRelaxNGSaveMemory(schema, &mem, &size) < 0)) {
+        fprintf(stderr, "testRelaxNGSaveLoad: save failed\n");
+        err = 1;
+        goto done;
+    }
+    loaded = xmlRelaxNGLoadMemory((const char *) mem, size);
+    if (loaded == NULL) {
+        fprintf(stderr, "testRelaxNGSaveLoad: load failed\n");
+        err = 1;
+        goto done;
+    }
 
-    return XML_IO_ENAMETOOLONG;
+    for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); i++) {
+        xmlRelaxNGValidCtxtPtr vctxt;
+        xmlDocPtr doc;
+        int ret;
+
+        doc = xmlReadDoc(BAD_CAST tests[i].doc, NULL, NULL, 0);
+        vctxt = xmlRelaxNGNewValidCtxt(loaded);
+        xmlRelaxNGSetValidStructuredErrors(vctxt, ignoreError, NULL);
+        ret = xmlRelaxNGValidateDoc(vctxt, doc);
+        if ((ret == 0) != tests[i].valid) {
+            fprintf(stderr, "testRelaxNGSaveLoad: wrong result for %s\n",
+                    tests[i].doc);
+            err = 1;
+        }
+        xmlRelaxNGFreeValidCtxt(vctxt);
+        xmlFreeDoc(doc);
+    }
+
+    /* Truncated input is rejected */
+    for (i = 0; i < size; i++) {
+        bad = xmlRelaxNGLoadMemory((const char *) mem, i);
+        if (bad != NULL) {
+            fprintf(stderr, "testRelaxNGSaveLoad: loaded %d bytes\n", i);
+            xmlRelaxNGFree(bad);
+            err = 1;
+            break;
+        }
+    }
+
+done:
+    xmlFree(mem);
+    xmlRelaxNGFree(loaded);
+    xmlRelaxNGFree(schema);
+    return(err);
 }
 
 static int
-testWriterClose(void){
-    xmlOutputBufferPtr out;
-    xmlTextWriterPtr writer;
-    int err = 0;
-    int result;
+testRelaxNGDataParams(void) {
+    const char *rng =
+        "<element name='doc' xmlns='http://relaxng.org/ns/structure/1.0'\n"
+        "  datatypeLibrary='http://www.w3.org/2001/XMLSchema-datatypes'>\n"
+        "  <attribute name='id'><data type='ID'/></attribute>\n"
+        "  <zeroOrMore><element name='n'><data type='integer'>\n"
+        "    <param name='minInclusive'>1</param>\n"
+        "    <param name='maxExclusive'>10</param>\n"
+        "  </data></element></zeroOrMore>\n"
+        "  <zeroOrMore><element name='s'><data type='token'>\n"
+        "    <param name='maxLength'>4</param>\n"
+        "    <except><value>none</value></except>\n"
+        "  </data></element></zeroOrMore>\n"
+        "  <zeroOrMore><element name='x'><data type='int'>\n"
+        "    <param name='noSuchFacet'>1</param>\n"
+        "  </data></element></zeroOrMore>\n"
+        "</element>\n";
+    static const struct {
+        const char *doc;
+        int valid;
+    } tests[] = {
+        { "<doc id='a'><n>1</n><n> 9 </n><s>abcd</s></doc>", 1 },
+        { "<doc id='a'><n>0</n></doc>", 0 },
+        { "<doc id='a'><n>10</n></doc>", 0 },
+        { "<doc id='a'><n>1.5</n></doc>", 0 },
+        { "<doc id='a'><s>abcde</s></doc>", 0 },
+        { "<doc id='a'><s>none</s></doc>", 0 },
+        { "<doc id='a'><x>1</x></doc>", 0 },
+    };
+    xmlRelaxNGParserCtxtPtr pctxt;
+    xmlRelaxNGValidCtxtPtr vctxt;
+    xmlRelaxNGPtr schema;
+    int i, ret, err = 0;
+
+    pctxt = xmlRelaxNGNewMemParserCtxt(rng, strlen(rng));
+    schema = xmlRelaxNGParse(pctxt);
+    xmlRelaxNGFreeParserCtxt(pctxt);
+    if (schema == NULL) {
+        fprintf(stderr, "testRelaxNGDataParams: parse failed\n");
+        return(1);
+    }
+    vctxt = xmlRelaxNGNewValidCtxt(schema);
+    xmlRelaxNGSetValidStructuredErrors(vctxt, ignoreError, NULL);
 
-    out = xmlOutputBufferCreateIO(testWriterIOWrite, testWriterIOClose,
-                                  NULL, NULL);
-    writer = xmlNewTextWriter(out);
-    xmlTextWriterStartDocument(writer, "1.0", "UTF-8", NULL);
-    xmlTextWriterStartElement(writer, BAD_CAST "elem");
-    xmlTextWriterEndElement(writer);
-    xmlTextWriterEndDocument(writer);
-    result = xmlTextWriterClose(writer);
+    for (i = 0; i < (int) (sizeof(tests) / sizeof(tests[0])); i++) {
+        xmlDocPtr doc = xmlReadDoc(BAD_CAST tests[i].doc, NULL, NULL, 0);
 
-    if (result != XML_IO_ENAMETOOLONG) {
-        fprintf(stderr, "xmlTextWriterClose reported wrong error %d\n",
-                result);
-        err = 1;
+        ret = xmlRelaxNGValidateDoc(vctxt, doc);
+        if ((ret == 0) != tests[i].valid) {
+            fprintf(stderr, "testRelaxNGDataParams: wrong result for %s\n",
+                    tests[i].doc);
+            err = 1;
+        }
+        xmlFreeDoc(doc);
     }
 
-    xmlFreeTextWriter(writer);
-    return err;
+    xmlRelaxNGFreeValidCtxt(vctxt);
+    xmlRelaxNGFree(schema);
+    return(err);
 }
-#endif
+#endif /* LIBXML_RELAXNG_ENABLED */
 
-typedef struct {
-    const char *uri;
-    const char *base;
-    const char *result;
-} xmlRelativeUriTest;
+#if defined(LIBXML_SCHEMATRON_ENABLED) && defined(LIBXML_SCHEMAS_ENABLED)
+/* Shares the error log of testSchemaParallel */
+static int
+testSchematronParallelValidate(xmlSchematronPtr schema, xmlDocPtr doc,
+                               int nbThreads, testSchemaParallelLog *log) {
+    xmlSchematronValidCtxtPtr vctxt;
+    int ret;
+
+    log->len = 0;
+    log->buf[0] = 0;
+    vctxt = xmlSchematronNewValidCtxt(schema, XML_SCHEMATRON_OUT_ERROR);
+    if (vctxt == NULL)
+        return(-2);
+    xmlSchematronSetValidStructuredErrors(vctxt, testSchemaParallelError,
+                                          log);
+    if ((nbThreads > 1) &&
+        (xmlSchematronSetValidParallel(vctxt, nbThreads) < 0)) {
+        xmlSchematronFreeValidCtxt(vctxt);
+        return(-3);
+    }
+    /* XPath errors aren't passed to the structured handler */
+    xmlSetStructuredErrorFunc(NULL, ignoreError);
+    ret = xmlSchematronValidateDoc(vctxt, doc);
+    xmlSetStructuredErrorFunc(NULL, NULL);
+    xmlSchematronFreeValidCtxt(vctxt);
+
+    return(ret);
+}
 
 static int
-testBuildRelativeUri(void) {
-    xmlChar *res;
+testSchematronParallel(void) {
+    const char *sct =
+        "<schema xmlns='http://purl.oclc.org/dsdl/schematron'>\n"
+        "  <pattern id='fields'>\n"
+        "    <rule context='field'>\n"
+        "      <let name='n' value='number(@n)'/>\n"
+        "      <assert test='$n = $n'>field <value-of select='@id'/>"
+        " is not a number</assert>\n"
+        "      <report test='@ref &gt; count(../field)'>bad ref"
+        " <value-of select='$n'/></report>\n"
+        "      <assert test='count(id(@id)) = 1'>bad id</assert>\n"
+        "    </rule>\n"
+        "  </pattern>\n"
+        "  <pattern id='records'>\n"
+        "    <rule context='record'>\n"
+        "      <assert test='count(field) = 30'>record size</assert>\n"
+        "      <assert test='not(extra) or unknown(.)'>extra</assert>\n"
+        "    </rule>\n"
+        "  </pattern>\n"
+        "</schema>\n";
+    static char xml[200000];
+    testSchemaParallelLog seqLog, parLog;
+    xmlSchematronParserCtxtPtr pctxt;
+    xmlSchematronPtr schema = NULL;
+    xmlDocPtr doc;
+    size_t len = 0;
+    int i, j, seqRet, parRet;
     int err = 0;
-    int i;
 
-    static const xmlRelativeUriTest tests[] = {
-        {
-            "/a/b1/c1",
-            "/a/b2/c2",
-            "../b1/c1"
-        }, {
-            "a/b1/c1",
-            "a/b2/c2",
-            "../b1/c1"
-        }, {
-            "a/././b1/x/y/../z/../.././c1",
-            "./a/./b2/././b2",
-            "../b1/c1"
-        }, {
-            "file:///a/b1/c1",
-            "/a/b2/c2",
-            NULL
-        }, {
-            "/a/b1/c1",
-            "file:///a/b2/c2",
-            NULL
-        }, {
-            "a/b1/c1",
-            "/a/b2/c2",
-            NULL
-        }, {
-            "/a/b1/c1",
-            "a/b2/c2",
-            NULL
-        }, {
-            "http://example.org/a/b1/c1",
-            "http://example.org/a/b2/c2",
-            "../b1/c1"
-        }, {
-            "http://example.org/a/b1/c1",
-            "https://example.org/a/b2/c2",
-            NULL
-        }, {
-            "http://example.org/a/b1/c1",
-            "http://localhost/a/b2/c2",
-            NULL
-        }, {
-            "with space/x x/y y",
-            "with space/b2/c2",
-            "../x%20x/y%20y"
-        }, {
-            "with space/x x/y y",
-            "/b2/c2",
-            "with%20space/x%20x/y%20y"
-        }
-#if defined(_WIN32) || defined(__CYGWIN__)
-        , {
-            "\\a\\b1\\c1",
-            "\\a\\b2\\c2",
-            "../b1/c1"
-        }, {
-            "\\a\\b1\\c1",
-            "/a/b2/c2",
-            "../b1/c1"
-        }, {
-            "a\\b1\\c1",
-            "a/b2/c2",
-            "../b1/c1"
-        }, {
-            "file://server/a/b1/c1",
-            "\\\\?\\UNC\\server\\a\\b2\\c2",
-            "../b1/c1"
-        }, {
-            "file://server/a/b1/c1",
-            "\\\\server\\a\\b2\\c2",
-            "../b1/c1"
-        }, {
-            "file:///x:/a/b1/c1",
-            "x:\\a\\b2\\c2",
-            "../b1/c1"
-        }, {
-            "file:///x:/a/b1/c1",
-            "\\\\?\\x:\\a\\b2\\c2",
-            "../b1/c1"
-        }, {
-            "file:///x:/a/b1/c1",
-            "file:///y:/a/b2/c2",
-            NULL
-        }, {
-            "x:/a/b1/c1",
-            "y:/a/b2/c2",
-            "file:///x:/a/b1/c1"
-        }, {
-            "/a/b1/c1",
-            "y:/a/b2/c2",
-            NULL
-        }, {
-            "\\\\server\\a\\b1\\c1",
-            "a/b2/c2",
-            "file://server/a/b1/c1"
+    pctxt = xmlSchematronNewMemParserCtxt(sct, strlen(sct));
+    if (pctxt != NULL) {
+        schema = xmlSchematronParse(pctxt);
+        xmlSchematronFreeParserCtxt(pctxt);
+    }
+    if (schema == NULL) {
+        fprintf(stderr, "testSchematronParallel: parsing schema failed\n");
+        return(1);
+    }
+
+    /*
+     * Failed tests in several records and an XPath error which
+     * must be reported by the calling thread.
+     */
+    len += snprintf(xml + len, sizeof(xml) - len,
+                    "<!DOCTYPE doc [<!ATTLIST field id ID #IMPLIED>]>\n"
+                    "<doc>\n");
+    for (i = 0; i < 40; i++) {
+        len += snprintf(xml + len, sizeof(xml) - len, "<record>\n");
+        for (j = 0; j < ((i == 17) ? 29 : 30); j++) {
+            len += snprintf(xml + len, sizeof(xml) - len,
+                            "<field id='r%d-%d' n='%s%d' ref='%d'/>\n",
+                            i, j, ((i == 5) && (j == 7)) ? "x" : "", j,
+                            ((i == 10) && (j == 3)) ? 100 : j);
         }
-#endif
-    };
+        if (i == 30)
+            len += snprintf(xml + len, sizeof(xml) - len, "<extra/>\n");
+        len += snprintf(xml + len, sizeof(xml) - len, "</record>\n");
+    }
+    len += snprintf(xml + len, sizeof(xml) - len, "</doc>\n");
 
-    for (i = 0; (size_t) i < sizeof(tests) / sizeof(tests[0]); i++) {
-        const xmlRelativeUriTest *test = tests + i;
-        const char *expect;
+    doc = xmlReadMemory(xml, len, "parallel.xml", NULL, 0);
+    seqRet = testSchematronParallelValidate(schema, doc, 1, &seqLog);
+    xmlFreeDoc(doc);
+    doc = xmlReadMemory(xml, len, "parallel.xml", NULL, 0);
+    parRet = testSchematronParallelValidate(schema, doc, 4, &parLog);
+    xmlFreeDoc(doc);
 
-        res = xmlBuildRelativeURI(BAD_CAST test->uri, BAD_CAST test->base);
-        expect = test->result ? test->result : test->uri;
-        if (!xmlStrEqual(res, BAD_CAST expect)) {
-            fprintf(stderr, "xmlBuildRelativeURI failed uri=%s base=%s "
-                    "result=%s expected=%s\n", test->uri, test->base,
-                    res, expect);
+    if (parRet != -3) {
+        if ((seqRet <= 0) || (parRet != seqRet)) {
+            fprintf(stderr, "testSchematronParallel: results differ: "
+                    "%d %d\n", seqRet, parRet);
+            err = 1;
+        } else if (strcmp(seqLog.buf, parLog.buf) != 0) {
+            fprintf(stderr, "testSchematronParallel: errors differ:\n"
+                    "%s---\n%s", seqLog.buf, parLog.buf);
             err = 1;
         }
-        xmlFree(res);
     }
 
-    return err;
+    xmlSchematronFree(schema);
+    return(err);
 }
+#endif /* LIBXML_SCHEMATRON_ENABLED && LIBXML_SCHEMAS_ENABLED */
 
-#if defined(_WIN32) || defined(__CYGWIN__)
+#ifdef LIBXML_C14N_ENABLED
 static int
-testWindowsUri(void) {
-    const char *url = "c:/a%20b/file.txt";
-    xmlURIPtr uri;
-    xmlChar *res;
+testC14NDigestAppend(void *ctxt, const unsigned char *data, int len) {
+    return(xmlBufferAdd(ctxt, data, len) == 0 ? 0 : -1);
+}
+
+static int
+testC14NDigestAbort(void *ctxt ATTRIBUTE_UNUSED,
+                    const unsigned char *data ATTRIBUTE_UNUSED,
+                    int len ATTRIBUTE_UNUSED) {
+    return(-1);
+}
+
+static int
+testC14NDigestReferences(void) {
+    const char *xml =
+        "<?pi before?><!--c-->"
+        "<doc xmlns='urn:d' xmlns:a='urn:a' xml:lang='en'>"
+        "<a:head a:id='h'><t>x &amp; y</t><!--in--></a:head>"
+        "<body xmlns:b='urn:b' xml:space='preserve'>"
+        "<b:item b:n='1'>one</b:item><b:item b:n='2'>two</b:item>"
+        "<item xmlns=''>three</item>"
+        "</body>"
+        "</doc><!--after-->";
+    static const char *const exprs[] = {
+        NULL,
+        "(//. | //@* | //namespace::*)[ancestor-or-self::a:head]",
+        "(//. | //@* | //namespace::*)[ancestor-or-self::*[2]]",
+        "//b:item | //b:item/text()",
+        "//node() | //@*"
+    };
+    static const int modes[] = {
+        XML_C14N_1_0, XML_C14N_EXCLUSIVE_1_0, XML_C14N_1_1,
+        XML_C14N_1_0, XML_C14N_EXCLUSIVE_1_0
+    };
+    static const xmlChar *const prefixes[] = { BAD_CAST "b", NULL };
+    xmlC14NReference refs[5];
+    xmlXPathObjectPtr objs[5];
+    xmlBufferPtr bufs[5];
+    xmlDocPtr doc;
+    xmlXPathContextPtr xpctxt;
     int err = 0;
     int i;
 
-    static const xmlRelativeUriTest tests[] = {
-        {
-            "c:/a%20b/file.txt",
-            "base.xml",
-            "c:/a b/file.txt"
-        }, {
-            "file:///c:/a%20b/file.txt",
-            "base.xml",
-            "file:///c:/a%20b/file.txt"
-        }, {
-            "Z:/a%20b/file.txt",
-            "http://example.com/",
-            "Z:/a b/file.txt"
-        }, {
-            "a%20b/b1/c1",
-            "C:/a/b2/c2",
-            "C:/a/b2/a b/b1/c1"
-        }, {
-            "a%20b/b1/c1",
-            "\\a\\b2\\c2",
-            "/a/b2/a b/b1/c1"
-        }, {
-            "a%20b/b1/c1",
-            "\\\\?\\a\\b2\\c2",
-            "//?/a/b2/a b/b1/c1"
-        }, {
-            "a%20b/b1/c1",
-            "\\\\\\\\server\\b2\\c2",
-            "//server/b2/a b/b1/c1"
+    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, 0);
+    xpctxt = xmlXPathNewContext(doc);
+    xmlXPathRegisterNs(xpctxt, BAD_CAST "a", BAD_CAST "urn:a");
+    xmlXPathRegisterNs(xpctxt, BAD_CAST "b", BAD_CAST "urn:b");
+
+    memset(refs, 0, sizeof(refs));
+    for (i = 0; i < 5; i++) {
+        objs[i] = (exprs[i] != NULL) ?
+                  xmlXPathEvalExpression(BAD_CAST exprs[i], xpctxt) : NULL;
+        bufs[i] = xmlBufferCreate();
+        refs[i].nodes = (objs[i] != NULL) ? objs[i]->nodesetval : NULL;
+        refs[i].mode = modes[i];
+        refs[i].inclusive_ns_prefixes = (xmlChar **) prefixes;
+        refs[i].with_comments = i & 1;
+        refs[i].digest = testC14NDigestAppend;
+        refs[i].ctxt = bufs[i];
+    }
+
+    if (xmlC14NDigestReferences(doc, refs, 5) != 0) {
+        fprintf(stderr, "testC14NDigestReferences: failed\n");
+        err = 1;
+    }
+    for (i = 0; i < 5; i++) {
+        xmlChar *expected = NULL;
+        int size;
+
+        size = xmlC14NDocDumpMemory(doc, refs[i].nodes, refs[i].mode,
+                                    refs[i].inclusive_ns_prefixes,
+                                    refs[i].with_comments, &expected);
+        if ((size < 0) || (xmlBufferLength(bufs[i]) != size) ||
+            (memcmp(xmlBufferContent(bufs[i]), expected, size) != 0)) {
+            fprintf(stderr, "testC14NDigestReferences: reference %d: "
+                    "got\n%s\nexpected\n%s\n", i,
+                    xmlBufferContent(bufs[i]), expected);
+            err = 1;
         }
+        xmlFree(expected);
+    }
+
+    /* Errors of the callback abort canonicalization */
+    refs[2].digest = testC14NDigestAbort;
+    if (xmlC14NDigestReferences(doc, refs, 5) >= 0) {
+        fprintf(stderr, "testC14NDigestReferences: callback error "
+                "ignored\n");
+        err = 1;
+    }
+
+    for (i = 0; i < 5; i++) {
+        xmlXPathFreeObject(objs[i]);
+        xmlBufferFree(bufs[i]);
+    }
+    xmlXPathFreeContext(xpctxt);
+    xmlFreeDoc(doc);
+    return(err);
+}
+#endif /* LIBXML_C14N_ENABLED */
+
+#ifdef LIBXML_C14N_ENABLED
+static int
+testC14NAttrOrder(void) {
+    /* the last document has enough attributes to be sorted by qsort */
+    static const char *const docs[] = {
+        "<s b='' a='' xmlns:q='urn:b' xmlns:p='urn:a' q:x='' p:x=''/>",
+        "<s xmlns:p=\"urn:a\" xmlns:q=\"urn:b\" a=\"\" b=\"\" "
+            "p:x=\"\" q:x=\"\"></s>",
+
+        "<s xmlns:p='urn:a' a='' b='' p:x=''/>",
+        "<s xmlns:p=\"urn:a\" a=\"\" b=\"\" p:x=\"\"></s>",
+
+        "<r xmlns:z='urn:a' xmlns:b='urn:b' xmlns:y='urn:c' "
+            "b:k='1' z:k='2' "
+            "a20='' a19='' a18='' a17='' a16='' "
+            "a15='' a14='' a13='' a12='' a11='' "
+            "a10='' a09='' a08='' a07='' a06='' "
+            "a05='' a04='' a03='' a02='' a01='' "
+            "y:a='3'/>",
+        "<r xmlns:b=\"urn:b\" xmlns:y=\"urn:c\" xmlns:z=\"urn:a\" "
+            "a01=\"\" a02=\"\" a03=\"\" a04=\"\" a05=\"\" "
+            "a06=\"\" a07=\"\" a08=\"\" a09=\"\" a10=\"\" "
+            "a11=\"\" a12=\"\" a13=\"\" a14=\"\" a15=\"\" "
+            "a16=\"\" a17=\"\" a18=\"\" a19=\"\" a20=\"\" "
+            "z:k=\"2\" b:k=\"1\" y:a=\"3\"></r>"
     };
+    int err = 0;
+    size_t i;
+    int mode;
 
-    uri = xmlParseURI(url);
-    if (uri == NULL) {
-        fprintf(stderr, "xmlParseURI failed\n");
-        err = 1;
-    } else {
-        if (uri->scheme != NULL) {
-            fprintf(stderr, "invalid scheme: %s\n", uri->scheme);
-            err = 1;
+    for (i = 0; i < sizeof(docs) / sizeof(docs[0]); i += 2) {
+        xmlDocPtr doc;
+
+        doc = xmlReadDoc(BAD_CAST docs[i], NULL, NULL, 0);
+        if (doc == NULL) {
+            fprintf(stderr, "testC14NAttrOrder: parse failed\n");
+            return(1);
         }
-        if (uri->path == NULL || strcmp(uri->path, "c:/a b/file.txt") != 0) {
-            fprintf(stderr, "invalid path: %s\n", uri->path);
-            err = 1;
+
+        for (mode = XML_C14N_1_0; mode <= XML_C14N_1_1; mode++) {
+            xmlChar *out = NULL;
+            int size;
+
+            size = xmlC14NDocDumpMemory(doc, NULL, mode, NULL, 0, &out);
+            if ((size < 0) || (!xmlStrEqual(out, BAD_CAST docs[i + 1]))) {
+                fprintf(stderr, "testC14NAttrOrder: doc %d, mode %d: "
+                        "got %s\n", (int) i / 2, mode,
+                        out ? (char *) out : "(null)");
+                err = 1;
+            }
+            xmlFree(out);
         }
 
-        xmlFreeURI(uri);
+        xmlFreeDoc(doc);
     }
 
-    for (i = 0; (size_t) i < sizeof(tests) / sizeof(tests[0]); i++) {
-        const xmlRelativeUriTest *test = tests + i;
+    return(err);
+}
+#endif /* LIBXML_C14N_ENABLED */
 
-        res = xmlBuildURI(BAD_CAST test->uri, BAD_CAST test->base);
-        if (res == NULL || !xmlStrEqual(res, BAD_CAST test->result)) {
-            fprintf(stderr, "xmlBuildURI failed uri=%s base=%s "
-                    "result=%s expected=%s\n", test->uri, test->base,
-                    res, test->result);
-            err = 1;
+#if defined(LIBXML_XINCLUDE_ENABLED) && defined(LIBXML_OUTPUT_ENABLED)
+#define TEST_XINCLUDE_DOCS 20
+
+typedef struct {
+    char names[TEST_XINCLUDE_DOCS + 1][64];
+    char contents[TEST_XINCLUDE_DOCS + 1][300];
+} testXIncludeDocs;
+
+static xmlParserErrors
+testXIncludeParallelLoader(void *vctxt, const char *url,
+                           const char *publicId ATTRIBUTE_UNUSED,
+                           xmlResourceType type ATTRIBUTE_UNUSED,
+                           xmlParserInputFlags flags ATTRIBUTE_UNUSED,
+                           xmlParserInputPtr *out) {
+    testXIncludeDocs *docs = vctxt;
+    int i;
+
+    /* Called from worker threads, the table is read-only */
+    for (i = 0; i <= TEST_XINCLUDE_DOCS; i++) {
+        if (strcmp(url, docs->names[i]) == 0) {
+            *out = xmlNewInputFromString(url, docs->contents[i],
+                                         XML_INPUT_BUF_STATIC);
+            return(*out != NULL ? XML_ERR_OK : XML_ERR_NO_MEMORY);
         }
-        xmlFree(res);
     }
 
-    return err;
+    *out = NULL;
+    return(XML_IO_ENOENT);
+}
+
+static void
+testXIncludeParallelError(void *ctxt, const xmlError *error) {
+    xmlBufferPtr log = ctxt;
+
+    xmlBufferCCat(log, error->file ? error->file : "-");
+    xmlBufferCCat(log, ": ");
+    xmlBufferCCat(log, error->message);
 }
-#endif /* WIN32 */
 
-#if defined(LIBXML_ICONV_ENABLED) || defined(LIBXML_ICU_ENABLED)
 static int
-testTruncatedMultiByte(void) {
-    const char xml[] =
-        "<?xml version=\"1.0\" encoding=\"EUC-JP\"?>\n"
-        "<doc/>\xC3";
-#ifdef LIBXML_HTML_ENABLED
-    const char html[] =
-        "<meta charset=\"EUC-JP\">\n"
-        "<div/>\xC3";
-#endif
+testXIncludeParallelRun(testXIncludeDocs *docs, const char *xml,
+                        int nbThreads, xmlChar **out, xmlBufferPtr log) {
+    xmlXIncludeCtxtPtr ctxt;
     xmlDocPtr doc;
-    const xmlError *error;
-    int err = 0;
-
-    xmlResetLastError();
-    doc = xmlReadDoc(BAD_CAST xml, NULL, NULL, XML_PARSE_NOERROR);
-    error = xmlGetLastError();
-    if (error == NULL || error->code != XML_ERR_INVALID_ENCODING) {
-        fprintf(stderr, "xml, pull: expected XML_ERR_INVALID_ENCODING\n");
-        err = 1;
+    int size, ret;
+
+    doc = xmlReadMemory(xml, strlen(xml), "http://example.org/main.xml",
+                        NULL, 0);
+    if (doc == NULL)
+        return(-2);
+    ctxt = xmlXIncludeNewContext(doc);
+    xmlXIncludeSetErrorHandler(ctxt, testXIncludeParallelError, log);
+    xmlXIncludeSetResourceLoader(ctxt, testXIncludeParallelLoader, docs);
+    if ((nbThreads > 1) && (xmlXIncludeSetParallel(ctxt, nbThreads) < 0)) {
+        xmlXIncludeFreeContext(ctxt);
+        xmlFreeDoc(doc);
+        return(-3);
     }
+    ret = xmlXIncludeProcessNode(ctxt, (xmlNodePtr) doc);
+    xmlXIncludeFreeContext(ctxt);
+    xmlDocDumpMemory(doc, out, &size);
     xmlFreeDoc(doc);
 
-#ifdef LIBXML_HTML_ENABLED
-    xmlResetLastError();
-    doc = htmlReadDoc(BAD_CAST html, NULL, NULL, XML_PARSE_NOERROR);
-    error = xmlGetLastError();
-    if (error == NULL || error->code != XML_ERR_INVALID_ENCODING) {
-        fprintf(stderr, "html, pull: expected XML_ERR_INVALID_ENCODING\n");
-        err = 1;
+    return(ret);
+}
+
+static int
+testXIncludeParallel(void) {
+    static testXIncludeDocs docs;
+    static char xml[10000];
+    xmlBufferPtr seqLog, parLog;
+    xmlChar *seqOut = NULL, *parOut = NULL;
+    size_t len = 0;
+    int i, seqRet, parRet;
+    int err = 0;
+
+    /*
+     * Some documents include others, one is malformed.
+     */
+    for (i = 0; i < TEST_XINCLUDE_DOCS; i++) {
+        snprintf(docs.names[i], sizeof(docs.names[i]),
+                 "http://example.org/inc%d.xml", i);
+        if (i == 13)
+            snprintf(docs.contents[i], sizeof(docs.contents[i]),
+                     "<part n='%d'><a></part>", i);
+        else
+            snprintf(docs.contents[i], sizeof(docs.contents[i]),
+                     "<part n='%d' "
+                     "xmlns:xi='http://www.w3.org/2001/XInclude'>"
+                     "<a xml:id='a%d'>text %d</a>%s</part>",
+                     i, i, i,
+                     (i % 5 == 0) ? "<xi:include href='inc7.xml'/>" : "");
+    }
+    snprintf(docs.names[i], sizeof(docs.names[i]),
+             "http://example.org/sub/inc.xml");
+    snprintf(docs.contents[i], sizeof(docs.contents[i]), "<sub/>");
+
+    len += snprintf(xml + len, sizeof(xml) - len,
+                    "<doc xmlns:xi='http://www.w3.org/2001/XInclude'>\n");
+    for (i = 0; i < 50; i++) {
+        if (i % 7 == 3)
+            len += snprintf(xml + len, sizeof(xml) - len,
+                            "<xi:include href='inc%d.xml' xpointer='a%d'/>\n",
+                            i % TEST_XINCLUDE_DOCS, i % TEST_XINCLUDE_DOCS);
+        else
+            len += snprintf(xml + len, sizeof(xml) - len,
+                            "<xi:include href='inc%d.xml'/>\n",
+                            i % TEST_XINCLUDE_DOCS);
+    }
+    len += snprintf(xml + len, sizeof(xml) - len,
+                    "<xi:include href='missing.xml'>"
+                    "<xi:fallback>none</xi:fallback></xi:include>\n"
+                    "<xi:include href='inc4.xml' parse='text'/>\n"
+                    "<x xml:base='sub/'><xi:include href='inc.xml'/></x>\n"
+                    "</doc>\n");
+
+    seqLog = xmlBufferCreate();
+    parLog = xmlBufferCreate();
+    seqRet = testXIncludeParallelRun(&docs, xml, 1, &seqOut, seqLog);
+    parRet = testXIncludeParallelRun(&docs, xml, 4, &parOut, parLog);
+
+    if (parRet != -3) {
+        /* The malformed document makes processing fail */
+        if ((seqRet != -1) || (parRet != seqRet) ||
+            (seqOut == NULL) || (parOut == NULL) ||
+            (strcmp((char *) seqOut, (char *) parOut) != 0)) {
+            fprintf(stderr, "testXIncludeParallel: results differ: "
+                    "%d %d\n", seqRet, parRet);
+            err = 1;
+        } else if ((strstr((char *) seqOut, "<sub/>") == NULL) ||
+                   (strstr((char *) xmlBufferContent(seqLog),
+                           "inc13.xml") == NULL) ||
+                   (strcmp((char *) xmlBufferContent(seqLog),
+                           (char *) xmlBufferContent(parLog)) != 0)) {
+            fprintf(stderr, "testXIncludeParallel: errors differ:\n"
+                    "%s---\n%s", xmlBufferContent(seqLog),
+                    xmlBufferContent(parLog));
+            err = 1;
+        }
     }
-    xmlFreeDoc(doc);
-#endif /* LIBXML_HTML_ENABLED */
 
-#ifdef LIBXML_PUSH_ENABLED
-    {
-        xmlParserCtxtPtr ctxt;
+    xmlFree(seqOut);
+    xmlFree(parOut);
+    xmlBufferFree(seqLog);
+    xmlBufferFree(parLog);
+    return(err);
+}
 
-        ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL);
-        xmlCtxtSetOptions(ctxt, XML_PARSE_NOERROR);
+static int testXIncludeCacheLoads;
 
-        xmlParseChunk(ctxt, xml, sizeof(xml) - 1, 0);
-        xmlParseChunk(ctxt, "", 0, 1);
+static xmlParserErrors
+testXIncludeCacheLoader(void *vctxt ATTRIBUTE_UNUSED, const char *url,
+                        const char *publicId ATTRIBUTE_UNUSED,
+                        xmlResourceType type ATTRIBUTE_UNUSED,
+                        xmlParserInputFlags flags ATTRIBUTE_UNUSED,
+                        xmlParserInputPtr *out) {
+    const char *content;
 
-        if (ctxt->errNo != XML_ERR_INVALID_ENCODING) {
-            fprintf(stderr, "xml, push: expected XML_ERR_INVALID_ENCODING\n");
-            err = 1;
-        }
+    if (strcmp(url, "http://example.org/part.xml") == 0)
+        content = "<!DOCTYPE part [<!ATTLIST e id ID #IMPLIED>]>\n"
+                  "<part><e id='e1'>one</e><e id='e2'>two</e></part>";
+    else if (strcmp(url, "http://example.org/note.txt") == 0)
+        content = "a note";
+    else
+        return(XML_IO_ENOENT);
+
+    testXIncludeCacheLoads++;
+    *out = xmlNewInputFromString(url, content, XML_INPUT_BUF_STATIC);
+    return(*out != NULL ? XML_ERR_OK : XML_ERR_NO_MEMORY);
+}
 
-        xmlFreeDoc(ctxt->myDoc);
-        xmlFreeParserCtxt(ctxt);
+static xmlChar *
+testXIncludeCacheRun(xmlXIncludeCache *cache) {
+    const char *xml =
+        "<doc xmlns:xi='http://www.w3.org/2001/XInclude'>"
+        "<xi:include href='part.xml'/>"
+        "<xi:include href='part.xml' xpointer='e2'/>"
+        "<xi:include href='note.txt' parse='text'/>"
+        "</doc>";
+    xmlXIncludeCtxtPtr ctxt;
+    xmlDocPtr doc;
+    xmlChar *out = NULL;
+    int size;
 
-#ifdef LIBXML_HTML_ENABLED
-        ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, NULL,
-                                        XML_CHAR_ENCODING_NONE);
-        xmlCtxtSetOptions(ctxt, XML_PARSE_NOERROR);
+    doc = xmlReadMemory(xml, strlen(xml), "http://example.org/main.xml",
+                        NULL, 0);
+    ctxt = xmlXIncludeNewContext(doc);
+    xmlXIncludeSetResourceLoader(ctxt, testXIncludeCacheLoader, NULL);
+    xmlXIncludeSetCache(ctxt, cache);
+    if (xmlXIncludeProcessNode(ctxt, (xmlNodePtr) doc) == 3)
+        xmlDocDumpMemory(doc, &out, &size);
+    xmlXIncludeFreeContext(ctxt);
+    xmlFreeDoc(doc);
 
-        htmlParseChunk(ctxt, html, sizeof(html) - 1, 0);
-        htmlParseChunk(ctxt, "", 0, 1);
+    return(out);
+}
 
-        if (ctxt->errNo != XML_ERR_INVALID_ENCODING) {
-            fprintf(stderr, "html, push: expected XML_ERR_INVALID_ENCODING\n");
-            err = 1;
+static int
+testXIncludeCache(void) {
+    int expect[] = { 2, 0, 2, 0, 2, 2 };
+    xmlXIncludeCache *cache;
+    xmlChar *ref, *out;
+    int i;
+    int err = 0;
+
+    ref = testXIncludeCacheRun(NULL);
+    if ((ref == NULL) || (strstr((char *) ref, "a note") == NULL)) {
+        fprintf(stderr, "testXIncludeCache: processing failed\n");
+        xmlFree(ref);
+        return(1);
+    }
+
+    cache = xmlXIncludeNewCache(1000000);
+    for (i = 0; i < 6; i++) {
+        /* Clear after the second run, too small after the fourth */
+        if (i == 2) {
+            xmlXIncludeCacheClear(cache);
+        } else if (i == 4) {
+            xmlXIncludeFreeCache(cache);
+            cache = xmlXIncludeNewCache(100);
         }
 
-        xmlFreeDoc(ctxt->myDoc);
-        htmlFreeParserCtxt(ctxt);
-#endif /* LIBXML_HTML_ENABLED */
+        testXIncludeCacheLoads = 0;
+        out = testXIncludeCacheRun(cache);
+        if ((out == NULL) || (strcmp((char *) out, (char *) ref) != 0)) {
+            fprintf(stderr, "testXIncludeCache: run %d: wrong result\n", i);
+            err = 1;
+        }
+        if (testXIncludeCacheLoads != expect[i]) {
+            fprintf(stderr, "testXIncludeCache: run %d: %d loads\n",
+                    i, testXIncludeCacheLoads);
+            err = 1;
+        }
+        xmlFree(out);
     }
-#endif /* LIBXML_PUSH_ENABLED */
 
-    return err;
+    xmlXIncludeFreeCache(cache);
+    xmlFree(ref);
+    return(err);
 }
-#endif /* iconv || icu */
+#endif /* LIBXML_XINCLUDE_ENABLED && LIBXML_OUTPUT_ENABLED */
 
-static int charEncConvImplError;
+#ifdef LIBXML_XPTR_ENABLED
+static int
+testXPtrCompileCount(xmlXPtrCompExprPtr comp, xmlXPathContextPtr ctx) {
+    xmlXPathObjectPtr obj;
+    int n;
+
+    obj = xmlXPtrCompiledEval(comp, ctx);
+    if ((obj == NULL) || (obj->type != XPATH_NODESET))
+        n = -1;
+    else
+        n = xmlXPathNodeSetGetLength(obj->nodesetval);
+    xmlXPathFreeObject(obj);
+    return(n);
+}
 
-static xmlCharEncError
-rot13Convert(void *vctxt, unsigned char *out, int *outlen,
-             const unsigned char *in, int *inlen,
-             int flush ATTRIBUTE_UNUSED) {
-    int *ctxt = vctxt;
-    int inSize = *inlen;
-    int outSize = *outlen;
-    int rot, i;
+static int
+testXPtrCompile(void) {
+    const char *xml1 = "<a xmlns='urn:p'><b/><c/><b/></a>";
+    const char *xml2 = "<a xmlns='urn:p'><b/></a>";
+    xmlDocPtr doc1, doc2;
+    xmlXPathContextPtr ctx;
+    xmlXPtrCompExprPtr comp;
+    int err = 0;
 
-    rot = *ctxt;
+    doc1 = xmlReadDoc(BAD_CAST xml1, NULL, NULL, 0);
+    doc2 = xmlReadDoc(BAD_CAST xml2, NULL, NULL, 0);
+    ctx = xmlXPathNewContext(doc1);
+    xmlXPathSetErrorHandler(ctx, ignoreError, NULL);
 
-    for (i = 0; i < inSize && i < outSize; i++) {
-        int c = in[i];
+    /* One compiled expression, several documents */
+    comp = xmlXPtrCompile(BAD_CAST "xmlns(p=urn:p) xpointer(//p:b)", ctx);
+    if ((comp == NULL) || (testXPtrCompileCount(comp, ctx) != 2)) {
+        fprintf(stderr, "testXPtrCompile: xpointer() failed\n");
+        err = 1;
+    }
+    ctx->doc = doc2;
+    if ((comp != NULL) && (testXPtrCompileCount(comp, ctx) != 1)) {
+        fprintf(stderr, "testXPtrCompile: reevaluation failed\n");
+        err = 1;
+    }
+    ctx->doc = doc1;
+    xmlXPtrFreeCompExpr(comp);
 
-        if (c >= 'A' && c <= 'Z')
-            c = 'A' + (c - 'A' + rot) % 26;
-        else if (c >= 'a' && c <= 'z')
-            c = 'a' + (c - 'a' + rot) % 26;
+    comp = xmlXPtrCompile(BAD_CAST "element(/1/3)", ctx);
+    if ((comp == NULL) || (testXPtrCompileCount(comp, ctx) != 1)) {
+        fprintf(stderr, "testXPtrCompile: element() failed\n");
+        err = 1;
+    }
+    xmlXPtrFreeCompExpr(comp);
 
-        out[i] = c;
+    /* Later parts are checked when compiling */
+    comp = xmlXPtrCompile(BAD_CAST "element(/1)xpointer(((", ctx);
+    if ((comp != NULL) || (ctx->lastError.code == XML_ERR_OK)) {
+        fprintf(stderr, "testXPtrCompile: syntax error not detected\n");
+        err = 1;
     }
+    xmlXPtrFreeCompExpr(comp);
 
-    *inlen = i;
-    *outlen = i;
+    /* Unknown schemes fail when evaluated */
+    comp = xmlXPtrCompile(BAD_CAST "foo(bar)element(/1)", ctx);
+    if ((comp == NULL) || (testXPtrCompileCount(comp, ctx) != -1)) {
+        fprintf(stderr, "testXPtrCompile: unknown scheme accepted\n");
+        err = 1;
+    }
+    xmlXPtrFreeCompExpr(comp);
 
-    return XML_ENC_ERR_SUCCESS;
-}
+    comp = xmlXPtrCompile(BAD_CAST "element(/1/9)xpath1(/*)", ctx);
+    if ((comp == NULL) || (testXPtrCompileCount(comp, ctx) != 1)) {
+        fprintf(stderr, "testXPtrCompile: fallback part failed\n");
+        err = 1;
+    }
+    xmlXPtrFreeCompExpr(comp);
 
-static void
-rot13ConvCtxtDtor(void *vctxt) {
-    xmlFree(vctxt);
+    xmlXPathFreeContext(ctx);
+    xmlFreeDoc(doc1);
+    xmlFreeDoc(doc2);
+    return(err);
 }
+#endif /* LIBXML_XPTR_ENABLED */
 
-static xmlParserErrors
-rot13ConvImpl(void *vctxt ATTRIBUTE_UNUSED, const char *name,
-              xmlCharEncFlags flags, xmlCharEncodingHandler **out) {
-    int *inputCtxt;
+#ifdef LIBXML_CATALOG_ENABLED
+static int
+testCatalogMemoCheck(xmlCatalogPtr catal, const char *pubID,
+                     const char *expect) {
+    xmlChar *ret;
+    int err = 0;
 
-    if (strcmp(name, "rot13") != 0)
-        return xmlCreateCharEncodingHandler(name, flags, NULL, NULL, out);
+    ret = xmlACatalogResolvePublic(catal, BAD_CAST pubID);
+    if ((expect == NULL) ? (ret != NULL) :
+        ((ret == NULL) || (strcmp((char *) ret, expect) != 0))) {
+        fprintf(stderr, "testCatalogMemo: %s resolved to %s\n",
+                pubID, ret ? (char *) ret : "NULL");
+        err = 1;
+    }
+    xmlFree(ret);
+    return(err);
+}
 
-    if (flags & XML_ENC_OUTPUT)
-        return XML_ERR_UNSUPPORTED_ENCODING;
+static int
+testCatalogMemo(void) {
+    const char *docbook = "-//OASIS//DTD DocBook XML V4.1.2//EN";
+    xmlCatalogPtr catal;
+    xmlChar *ret;
+    char pubID[50];
+    int i, j;
+    int err = 0;
 
-    inputCtxt = xmlMalloc(sizeof(*inputCtxt));
-    *inputCtxt = 13;
+    catal = xmlLoadACatalog("test/catalogs/whitex.xml");
+    if (catal == NULL) {
+        fprintf(stderr, "testCatalogMemo: loading catalog failed\n");
+        return(1);
+    }
+    xmlCatalogSetMemoLimit(10);
+
+    /* Memoized hits and misses, more than the limit */
+    for (j = 0; j < 2; j++) {
+        err |= testCatalogMemoCheck(catal, docbook,
+                "http://www.oasis-open.org/docbook/xml/4.1.2/docbookx.dtd");
+        for (i = 0; i < 25; i++) {
+            snprintf(pubID, sizeof(pubID), "-//TEST//DTD Missing %d//EN", i);
+            err |= testCatalogMemoCheck(catal, pubID, NULL);
+        }
+    }
 
-    return xmlCharEncNewCustomHandler(name, rot13Convert, NULL,
-                                      rot13ConvCtxtDtor, inputCtxt, NULL,
-                                      out);
+    /* Different kinds of lookups don't collide */
+    for (j = 0; j < 2; j++) {
+        ret = xmlACatalogResolveSystem(catal,
+                BAD_CAST "http://www.oasis-open.org/docbook/x.dtd");
+        if ((ret == NULL) ||
+            (strcmp((char *) ret, "/usr/share/xml/docbook/x.dtd") != 0)) {
+            fprintf(stderr, "testCatalogMemo: wrong system result\n");
+            err = 1;
+        }
+        xmlFree(ret);
+        ret = xmlACatalogResolve(catal, BAD_CAST docbook, NULL);
+        if ((ret == NULL) || (strstr((char *) ret, "docbookx.dtd") == NULL)) {
+            fprintf(stderr, "testCatalogMemo: wrong resolve result\n");
+            err = 1;
+        }
+        xmlFree(ret);
+    }
+
+    /* Changes invalidate memoized results */
+    err |= testCatalogMemoCheck(catal, "-//TEST//DTD Missing 3//EN", NULL);
+    err |= testCatalogMemoCheck(catal, docbook,
+            "http://www.oasis-open.org/docbook/xml/4.1.2/docbookx.dtd");
+    xmlACatalogAdd(catal, BAD_CAST "public",
+                   BAD_CAST "-//TEST//DTD Missing 3//EN",
+                   BAD_CAST "file:///missing3.dtd");
+    err |= testCatalogMemoCheck(catal, "-//TEST//DTD Missing 3//EN",
+                                "file:///missing3.dtd");
+    xmlACatalogAdd(catal, BAD_CAST "public", BAD_CAST docbook,
+                   BAD_CAST "file:///docbook.dtd");
+    err |= testCatalogMemoCheck(catal, docbook, "file:///docbook.dtd");
+    /* Removes the updated entry */
+    xmlACatalogRemove(catal, BAD_CAST "file:///docbook.dtd");
+    err |= testCatalogMemoCheck(catal, docbook, NULL);
+
+    xmlCatalogSetMemoLimit(0);
+    xmlFreeCatalog(catal);
+    return(err);
 }
 
 static int
-testCharEncConvImpl(void) {
-    xmlParserCtxtPtr ctxt;
-    xmlDocPtr doc;
-    xmlNodePtr root;
+testCatalogIndexCheck(xmlChar *ret, const char *id, const char *expect) {
     int err = 0;
 
-    ctxt = xmlNewParserCtxt();
-    xmlCtxtSetCharEncConvImpl(ctxt, rot13ConvImpl, NULL);
-    charEncConvImplError = 0;
-    doc = xmlCtxtReadDoc(ctxt, BAD_CAST "<?kzy irefvba='1.0'?><qbp/>", NULL,
-                         "rot13", 0);
-    if (charEncConvImplError)
-        err = 1;
-    xmlFreeParserCtxt(ctxt);
-
-    root = xmlDocGetRootElement(doc);
-    if (root == NULL || strcmp((char *) root->name, "doc") != 0) {
-        fprintf(stderr, "testCharEncConvImpl failed\n");
+    if ((expect == NULL) ? (ret != NULL) :
+        ((ret == NULL) || (strcmp((char *) ret, expect) != 0))) {
+        fprintf(stderr, "testCatalogIndex: %s resolved to %s\n",
+                id, ret ? (char *) ret : "NULL");
         err = 1;
     }
+    xmlFree(ret);
+    return(err);
+}
 
-    xmlFreeDoc(doc);
+static int
+testCatalogIndex(void) {
+    xmlCatalogPtr catal;
+    char id[100], url[100], expect[100];
+    int i;
+    int err = 0;
 
-    return err;
+    catal = xmlLoadACatalog("test/catalogs/stylesheet.xml");
+    if (catal == NULL) {
+        fprintf(stderr, "testCatalogIndex: loading catalog failed\n");
+        return(1);
+    }
+
+    for (i = 0; i < 300; i++) {
+        snprintf(id, sizeof(id), "http://example.org/sys%d.dtd", i);
+        snprintf(url, sizeof(url), "file:///sys%d.dtd", i);
+        xmlACatalogAdd(catal, BAD_CAST "system", BAD_CAST id, BAD_CAST url);
+        snprintf(id, sizeof(id), "http://example.org/uri%d.xsl", i);
+        snprintf(url, sizeof(url), "file:///uri%d.xsl", i);
+        xmlACatalogAdd(catal, BAD_CAST "uri", BAD_CAST id, BAD_CAST url);
+        snprintf(id, sizeof(id), "http://example.org/r%d/", i);
+        snprintf(url, sizeof(url), "file:///r%d/", i);
+        xmlACatalogAdd(catal, BAD_CAST "rewriteSystem", BAD_CAST id,
+                       BAD_CAST url);
+        xmlACatalogAdd(catal, BAD_CAST "rewriteURI", BAD_CAST id,
+                       BAD_CAST url);
+        if (i % 2 == 0) {
+            snprintf(id, sizeof(id), "http://example.org/r%d/sub/", i);
+            snprintf(url, sizeof(url), "file:///s%d/", i);
+            xmlACatalogAdd(catal, BAD_CAST "rewriteSystem", BAD_CAST id,
+                           BAD_CAST url);
+        }
+    }
+    /* Exact matches win over rewrite rules */
+    xmlACatalogAdd(catal, BAD_CAST "system",
+                   BAD_CAST "http://example.org/r7/sub/a.dtd",
+                   BAD_CAST "file:///exact.dtd");
+    /* Resolved through the delegate catalog's rewrite rule */
+    xmlACatalogAdd(catal, BAD_CAST "delegateSystem",
+                   BAD_CAST "http://www.oasis-open.org/docbook/",
+                   BAD_CAST "test/catalogs/docbook.xml");
+
+    for (i = 0; i < 300; i += 7) {
+        snprintf(id, sizeof(id), "http://example.org/sys%d.dtd", i);
+        snprintf(expect, sizeof(expect), "file:///sys%d.dtd", i);
+        err |= testCatalogIndexCheck(
+                xmlACatalogResolveSystem(catal, BAD_CAST id), id, expect);
+        snprintf(id, sizeof(id), "http://example.org/uri%d.xsl", i);
+        snprintf(expect, sizeof(expect), "file:///uri%d.xsl", i);
+        err |= testCatalogIndexCheck(
+                xmlACatalogResolveURI(catal, BAD_CAST id), id, expect);
+        /* Longest prefix wins */
+        snprintf(id, sizeof(id), "http://example.org/r%d/sub/a.dtd", i);
+        if (i == 7)
+            snprintf(expect, sizeof(expect), "file:///exact.dtd");
+        else if (i % 2 == 0)
+            snprintf(expect, sizeof(expect), "file:///s%d/a.dtd", i);
+        else
+            snprintf(expect, sizeof(expect), "file:///r%d/sub/a.dtd", i);
+        err |= testCatalogIndexCheck(
+                xmlACatalogResolveSystem(catal, BAD_CAST id), id, expect);
+        snprintf(expect, sizeof(expect), "file:///r%d/sub/a.dtd", i);
+        err |= testCatalogIndexCheck(
+                xmlACatalogResolveURI(catal, BAD_CAST id), id, expect);
+    }
+    err |= testCatalogIndexCheck(
+            xmlACatalogResolveSystem(catal,
+                BAD_CAST "http://example.org/r300/a.dtd"),
+            "r300", NULL);
+    err |= testCatalogIndexCheck(
+            xmlACatalogResolveSystem(catal,
+                BAD_CAST "http://www.oasis-open.org/docbook/x.dtd"),
+            "docbook", "/usr/share/xml/docbook/x.dtd");
+    err |= testCatalogIndexCheck(
+            xmlACatalogResolveURI(catal,
+                BAD_CAST "http://www.oasis-open.org/committes/tr.xsl"),
+            "tr.xsl",
+            "http://www.oasis-open.org/committes/entity/stylesheets/base/"
+            "tr.xsl");
+    err |= testCatalogIndexCheck(
+            xmlACatalogResolvePublic(catal, BAD_CAST "toto"),
+            "toto", "file:///usr/share/xml/toto/toto.dtd");
+
+    /* Changes are visible to later lookups */
+    xmlACatalogRemove(catal, BAD_CAST "file:///s4/");
+    xmlACatalogAdd(catal, BAD_CAST "rewriteSystem",
+                   BAD_CAST "http://example.org/r4/sub/a",
+                   BAD_CAST "file:///longer");
+    err |= testCatalogIndexCheck(
+            xmlACatalogResolveSystem(catal,
+                BAD_CAST "http://example.org/r4/sub/a.dtd"),
+            "r4", "file:///longer.dtd");
+    err |= testCatalogIndexCheck(
+            xmlACatalogResolveSystem(catal,
+                BAD_CAST "http://example.org/r4/sub/b.dtd"),
+            "r4", "file:///r4/sub/b.dtd");
+    xmlACatalogRemove(catal, BAD_CAST "http://example.org/sys14.dtd");
+    err |= testCatalogIndexCheck(
+            xmlACatalogResolveSystem(catal,
+                BAD_CAST "http://example.org/sys14.dtd"),
+            "sys14", NULL);
+
+    xmlFreeCatalog(catal);
+    return(err);
 }
+#endif /* LIBXML_CATALOG_ENABLED */
 
 int
 main(void) {
@@ -1496,17 +11581,66 @@ main(void) {
     err |= testUnsupportedEncoding();
     err |= testNodeGetContent();
     err |= testCFileIO();
+    err |= testResourceCache();
     err |= testUndeclEntInContent();
+#ifdef LIBXML_OUTPUT_ENABLED
+    err |= testEntityCopies();
+    err |= testAttrPlans();
+#endif
     err |= testInvalidCharRecovery();
+    err |= testScannedNames();
+    err |= testCharDataScan();
+    err |= testAttValueScan();
+    err |= testUtf8CharDataScan();
+    err |= testEscapeScan();
+    err |= testUTF16Conversion();
+    err |= testSingleByteConversion();
+    err |= testUTF8Strings();
     err |= testCtxtInputGetters();
+    err |= testDeferredErrors();
+    err |= testErrorPolicy();
+    err |= testPoolAlloc();
+    err |= testAllocProfile();
+    err |= testCtxtPool();
+    err |= testThreadPool();
+    err |= testReadBatch();
+    err |= testTrace();
+    err |= testCtxtStats();
 #ifdef LIBXML_VALID_ENABLED
     err |= testSwitchDtd();
+    err |= testSharedDtd();
+    err |= testLazyIds();
+    err |= testContentModelNames();
+    err |= testDtdDeclLookup();
 #endif
+    err |= testNameChars();
+    err |= testHashReserve();
+    err |= testReconcileNs();
 #ifdef LIBXML_OUTPUT_ENABLED
     err |= testCtxtParseContent();
     err |= testNoBlanks();
+    err |= testMmapInput();
+    err |= testAsyncInput();
+    err |= testArena();
+    err |= testArenaMove();
+    err |= testCopyTree();
+    err |= testDocSnapshot();
+    err |= testDocBinary();
+    err |= testDocImage();
+    err |= testTreeBuilder();
+    err |= testNodeContent();
+    err |= testFreeDocAsync();
     err |= testSaveNullEnc();
     err |= testDocDumpFormatMemoryEnc();
+    err |= testSaveSingleByteEnc();
+    err |= testChunkedOutput();
+    err |= testAsyncOutput();
+    err |= testParallelSave();
+    err |= testSaveMeasure();
+    err |= testSaveReset();
+    err |= testSourceSpans();
+    err |= testSourceSpansDefaults();
+    err |= testSourceSpansEntities();
 #endif
 #ifdef LIBXML_SAX1_ENABLED
     err |= testBalancedChunk();
@@ -1515,9 +11649,27 @@ main(void) {
     err |= testHugePush();
     err |= testHugeEncodedChunk();
     err |= testPushCDataEnd();
+    err |= testPushTextMerge();
+    err |= testPushLookahead();
+    err |= testPushBorrowed();
+    err |= testDocStream();
+#endif
+    err |= testTextSink();
+    err |= testLazyLines();
+#ifdef LIBXML_OUTPUT_ENABLED
+    err |= testParallelParse();
+#endif
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_OUTPUT_ENABLED)
+    err |= testPatternFilter();
+#endif
+#ifdef LIBXML_PATTERN_ENABLED
+    err |= testPatternSet();
 #endif
 #ifdef LIBXML_HTML_ENABLED
+    err |= testHtmlDataScan();
+    err |= testHtmlTokenizer();
     err |= testHtmlIds();
+    err |= testHtmlAutoClose();
 #ifdef LIBXML_OUTPUT_ENABLED
     err |= testHtmlInsertMetaEncoding();
     err |= testHtmlUpdateMetaEncoding();
@@ -1532,21 +11684,106 @@ main(void) {
     err |= testReaderContent();
 #endif
     err |= testReader();
+    err |= testReaderFlat();
+    err |= testReaderNextSkip();
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_OUTPUT_ENABLED)
+    err |= testReaderPreservePrune();
+#endif
+    err |= testReaderGetAttributes();
+    err |= testReaderPipelined();
+#ifdef LIBXML_SCHEMAS_ENABLED
+    err |= testReaderSchemaReuse();
+#endif
+#ifdef LIBXML_C14N_ENABLED
+    err |= testReaderC14NSubtree();
+#endif
 #ifdef LIBXML_XINCLUDE_ENABLED
     err |= testReaderXIncludeError();
 #endif
 #endif
 #ifdef LIBXML_WRITER_ENABLED
     err |= testWriterClose();
+    err |= testWriterTrusted();
+    err |= testWriterElements();
 #endif
     err |= testBuildRelativeUri();
+    err |= testBuildUri();
 #if defined(_WIN32) || defined(__CYGWIN__)
     err |= testWindowsUri();
 #endif
 #if defined(LIBXML_ICONV_ENABLED) || defined(LIBXML_ICU_ENABLED)
     err |= testTruncatedMultiByte();
+    err |= testPooledConverter();
 #endif
     err |= testCharEncConvImpl();
+#ifdef LIBXML_XPATH_ENABLED
+    err |= testXPathExprCache();
+    err |= testXPathOptimizer();
+    err |= testXPathKeys();
+    err |= testNameIndex();
+    err |= testValueIndex();
+    err |= testOrderIndex();
+    err |= testNodeSetMergeHash();
+    err |= testNodeSetInline();
+    err |= testChildIndex();
+    err |= testParallelFilter();
+    err |= testParallelFilterLazyIds();
+    err |= testFrozenDoc();
+    err |= testFrozenLazyIds();
+    err |= testIterate();
+    err |= testEvalMulti();
+    err |= testFastSteps();
+    err |= testNodeSetJoin();
+    err |= testThreadCache();
+    err |= testNumberRoundTrip();
+    err |= testXPathCoreFunctions();
+    err |= testXPathNsIds();
+#ifdef LIBXML_DEBUG_ENABLED
+    err |= testXPathProfile();
+    err |= testXPathSharedComp();
+#endif
+#endif
+#ifdef LIBXML_REGEXP_ENABLED
+    err |= testRegexpCache();
+    err |= testRegexpExecReset();
+    err |= testRegexpShared();
+#endif
+#ifdef LIBXML_SCHEMAS_ENABLED
+    err |= testSchemaSaveLoad();
+    err |= testSchemaValidCtxtPool();
+    err |= testSchemaExecReuse();
+    err |= testSchemaNameLookup();
+    err |= testSchemaWildcardNs();
+    err |= testSchemaParallel();
+    err |= testSchemaProfile();
+    err |= testSchemaValues();
+    err |= testSchemaRevalidate();
+    err |= testSchemaLazyImports();
+    err |= testSchemaParseThreads();
+#endif
+#ifdef LIBXML_RELAXNG_ENABLED
+    err |= testRelaxNGDerivatives();
+    err |= testRelaxNGSaveLoad();
+    err |= testRelaxNGDataParams();
+#endif
+#if defined(LIBXML_SCHEMATRON_ENABLED) && defined(LIBXML_SCHEMAS_ENABLED)
+    err |= testSchematronParallel();
+#endif
+#ifdef LIBXML_C14N_ENABLED
+    err |= testC14NDigestReferences();
+    err |= testC14NAttrOrder();
+#endif
+#if defined(LIBXML_XINCLUDE_ENABLED) && defined(LIBXML_OUTPUT_ENABLED)
+    err |= testXIncludeParallel();
+    err |= testXIncludeCache();
+#endif
+#ifdef LIBXML_XPTR_ENABLED
+    err |= testXPtrCompile();
+#endif
+#ifdef LIBXML_CATALOG_ENABLED
+    err |= testCatalogMemo();
+    err |= testCatalogIndex();
+#endif
 
     return err;
 }
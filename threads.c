@@ -12,6 +12,7 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <libxml/threads.h>
 #include <libxml/parser.h>
@@ -36,9 +37,21 @@
 #include "private/globals.h"
 #include "private/io.h"
 #include "private/memory.h"
+#include "private/parser.h"
+#include "private/regexp.h"
+#include "private/simd.h"
 #include "private/threads.h"
+#include "private/tree.h"
 #include "private/xpath.h"
 
+#if defined(_WIN32) && !defined(HAVE_WIN32_THREADS)
+#include <windows.h>
+#endif
+
+#ifdef HAVE_POSIX_THREADS
+#include <unistd.h>
+#endif
+
 /*
  * TODO: this module still uses malloc/free and not xmlMalloc/xmlFree
  *       to avoid some craziness since xmlMalloc/xmlFree may actually
@@ -306,6 +319,658 @@ xmlUnlockLibrary(void)
     xmlRMutexUnlock(&xmlLibraryLock);
 }
 
+/**
+ * Read a monotonic clock. Only differences between results are
+ * meaningful, and they wrap around like unsigned arithmetic.
+ *
+ * @returns the time in milliseconds.
+ */
+unsigned long
+xmlMonotonicTimeMs(void)
+{
+#if defined(_WIN32)
+    return((unsigned long) GetTickCount64());
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return((unsigned long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+    return((unsigned long) time(NULL) * 1000);
+#else
+    return((unsigned long) time(NULL) * 1000);
+#endif
+}
+
+/************************************************************************
+ *									*
+ *			Thread pool					*
+ *									*
+ ************************************************************************/
+
+/*
+ * Tasks are submitted to task groups and run by a pool of worker
+ * threads. Each worker has a deque of tasks. Tasks submitted from a
+ * worker are pushed onto its own deque and taken back in LIFO order.
+ * Tasks submitted from other threads go to a shared queue. Idle
+ * workers take tasks from the shared queue and steal from the other
+ * end of other deques.
+ *
+ * A task is also linked into the list of queued tasks of its group.
+ * Joining a group runs the tasks from this list which haven't been
+ * started yet, so the joining thread never waits for tasks which
+ * nobody runs. This also makes it possible to use the pool without
+ * any workers or with an external executor. A task which was taken
+ * from the group list is skipped when it's reached in a queue.
+ *
+ * Tasks are meant to be coarse-grained, so all state is protected
+ * by a single lock.
+ */
+
+#define XML_POOL_MAX_WORKERS 64
+
+typedef struct _xmlTask xmlTask;
+struct _xmlTask {
+    xmlTaskFunc func;
+    void *arg;
+    xmlTaskGroup *group;
+    /* Links in the list of queued tasks of the group */
+    xmlTask *prev;
+    xmlTask *next;
+    /* Set once the task was started */
+    int claimed;
+    /* Held by the group list and by a queue or the executor */
+    int refs;
+};
+
+#ifdef HAVE_POSIX_THREADS
+typedef pthread_cond_t xmlPoolCond;
+#elif defined HAVE_WIN32_THREADS
+typedef CONDITION_VARIABLE xmlPoolCond;
+#else
+typedef int xmlPoolCond;
+#endif
+
+struct _xmlTaskGroup {
+    xmlTask *first;
+    xmlTask *last;
+    /* Number of tasks which haven't finished */
+    int pending;
+    xmlPoolCond cond;
+};
+
+typedef struct {
+    xmlTask **tasks;
+    int head;
+    int count;
+    int size;
+} xmlTaskDeque;
+
+#ifdef HAVE_POSIX_THREADS
+typedef struct {
+    xmlTaskDeque deque;
+    int active;
+} xmlPoolWorker;
+#endif
+
+typedef struct {
+    xmlMutex lock;
+#ifdef HAVE_POSIX_THREADS
+    /* Signaled when tasks are queued or workers must exit */
+    xmlPoolCond cond;
+    /* Signaled when a worker exits */
+    xmlPoolCond exitCond;
+    xmlTaskDeque shared;
+    xmlPoolWorker workers[XML_POOL_MAX_WORKERS];
+    int nbWorkers;
+    int nbIdle;
+    int stop;
+#endif
+    /* Maximum number of workers, -1 if not set */
+    int size;
+    xmlTaskExecutorFunc executor;
+    void *executorData;
+} xmlThreadPool;
+
+static xmlThreadPool xmlPool;
+
+#ifdef HAVE_POSIX_THREADS
+#ifdef XML_THREAD_LOCAL
+static XML_THREAD_LOCAL xmlPoolWorker *xmlPoolCurrent;
+#define POOL_WORKER_GET() xmlPoolCurrent
+#define POOL_WORKER_SET(w) xmlPoolCurrent = (w)
+#else
+/* Submissions from workers go to the shared queue */
+#define POOL_WORKER_GET() NULL
+#define POOL_WORKER_SET(w) (void) (w)
+#endif
+#endif /* HAVE_POSIX_THREADS */
+
+#define POOL_LOCK() xmlMutexLock(&xmlPool.lock)
+#define POOL_UNLOCK() xmlMutexUnlock(&xmlPool.lock)
+
+static void
+xmlPoolCondInit(xmlPoolCond *cond) {
+#ifdef HAVE_POSIX_THREADS
+    pthread_cond_init(cond, NULL);
+#elif defined HAVE_WIN32_THREADS
+    InitializeConditionVariable(cond);
+#else
+    (void) cond;
+#endif
+}
+
+static void
+xmlPoolCondDestroy(xmlPoolCond *cond) {
+#ifdef HAVE_POSIX_THREADS
+    pthread_cond_destroy(cond);
+#else
+    (void) cond;
+#endif
+}
+
+/*
+ * Wait for a condition. Must be called with the pool lock held.
+ */
+static void
+xmlPoolCondWait(xmlPoolCond *cond) {
+#ifdef HAVE_POSIX_THREADS
+    pthread_cond_wait(cond, &xmlPool.lock.lock);
+#elif defined HAVE_WIN32_THREADS
+    SleepConditionVariableCS(cond, &xmlPool.lock.cs, INFINITE);
+#else
+    (void) cond;
+#endif
+}
+
+static void
+xmlPoolCondBroadcast(xmlPoolCond *cond) {
+#ifdef HAVE_POSIX_THREADS
+    pthread_cond_broadcast(cond);
+#elif defined HAVE_WIN32_THREADS
+    WakeAllConditionVariable(cond);
+#else
+    (void) cond;
+#endif
+}
+
+static void
+xmlTaskRelease(xmlTask *task) {
+    task->refs -= 1;
+    if (task->refs == 0)
+        free(task);
+}
+
+/*
+ * Take a task from the queued list of its group. Returns 1 if the
+ * task should be run by the caller. Must be called with the pool
+ * lock held.
+ */
+static int
+xmlTaskClaim(xmlTask *task) {
+    xmlTaskGroup *group = task->group;
+
+    if (task->claimed)
+        return(0);
+    task->claimed = 1;
+
+    if (task->prev != NULL)
+        task->prev->next = task->next;
+    else
+        group->first = task->next;
+    if (task->next != NULL)
+        task->next->prev = task->prev;
+    else
+        group->last = task->prev;
+
+    return(1);
+}
+
+/*
+ * Run a claimed task, releasing the reference of the group list.
+ * Must be called with the pool lock held which is released while
+ * the task runs.
+ */
+static void
+xmlTaskRun(xmlTask *task) {
+    xmlTaskGroup *group = task->group;
+    xmlTaskFunc func = task->func;
+    void *arg = task->arg;
+
+    xmlTaskRelease(task);
+
+    POOL_UNLOCK();
+    func(arg);
+    POOL_LOCK();
+
+    group->pending -= 1;
+    if (group->pending == 0)
+        xmlPoolCondBroadcast(&group->cond);
+}
+
+/*
+ * Entry point for tasks handed to an external executor.
+ */
+static void
+xmlTaskRunQueued(void *arg) {
+    xmlTask *task = arg;
+
+    POOL_LOCK();
+    if (xmlTaskClaim(task))
+        xmlTaskRun(task);
+    xmlTaskRelease(task);
+    POOL_UNLOCK();
+}
+
+#ifdef HAVE_POSIX_THREADS
+
+static int
+xmlTaskDequePush(xmlTaskDeque *deque, xmlTask *task) {
+    if (deque->count >= deque->size) {
+        xmlTask **tmp;
+        int newSize, i;
+
+        newSize = deque->size ? deque->size * 2 : 16;
+        tmp = malloc(newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        for (i = 0; i < deque->count; i++)
+            tmp[i] = deque->tasks[(deque->head + i) % deque->size];
+        free(deque->tasks);
+        deque->tasks = tmp;
+        deque->head = 0;
+        deque->size = newSize;
+    }
+
+    deque->tasks[(deque->head + deque->count) % deque->size] = task;
+    deque->count += 1;
+    return(0);
+}
+
+static xmlTask *
+xmlTaskDequePopBottom(xmlTaskDeque *deque) {
+    if (deque->count == 0)
+        return(NULL);
+    deque->count -= 1;
+    return(deque->tasks[(deque->head + deque->count) % deque->size]);
+}
+
+static xmlTask *
+xmlTaskDequePopTop(xmlTaskDeque *deque) {
+    xmlTask *task;
+
+    if (deque->count == 0)
+        return(NULL);
+    task = deque->tasks[deque->head];
+    deque->head = (deque->head + 1) % deque->size;
+    deque->count -= 1;
+    return(task);
+}
+
+static void
+xmlTaskDequeFree(xmlTaskDeque *deque) {
+    free(deque->tasks);
+    memset(deque, 0, sizeof(*deque));
+}
+
+/*
+ * Find a task for a worker. Must be called with the pool lock held.
+ */
+static xmlTask *
+xmlPoolTake(xmlPoolWorker *worker) {
+    xmlTask *task;
+    int i;
+
+    task = xmlTaskDequePopBottom(&worker->deque);
+    if (task != NULL)
+        return(task);
+
+    task = xmlTaskDequePopTop(&xmlPool.shared);
+    if (task != NULL)
+        return(task);
+
+    for (i = 0; i < XML_POOL_MAX_WORKERS; i++) {
+        task = xmlTaskDequePopTop(&xmlPool.workers[i].deque);
+        if (task != NULL)
+            return(task);
+    }
+
+    return(NULL);
+}
+
+static void *
+xmlPoolWorkerRun(void *data) {
+    xmlPoolWorker *worker = data;
+    xmlTask *task;
+    int index = worker - xmlPool.workers;
+
+    POOL_WORKER_SET(worker);
+
+    POOL_LOCK();
+    while (1) {
+        if ((xmlPool.stop) || (index >= xmlPool.size)) {
+            /* Hand remaining tasks to other workers or joiners */
+            while ((task = xmlTaskDequePopTop(&worker->deque)) != NULL) {
+                if (xmlTaskDequePush(&xmlPool.shared, task) < 0)
+                    xmlTaskRelease(task);
+            }
+            break;
+        }
+
+        task = xmlPoolTake(worker);
+        if (task != NULL) {
+            if (xmlTaskClaim(task))
+                xmlTaskRun(task);
+            xmlTaskRelease(task);
+            continue;
+        }
+
+        xmlPool.nbIdle += 1;
+        xmlPoolCondWait(&xmlPool.cond);
+        xmlPool.nbIdle -= 1;
+    }
+
+    xmlTaskDequeFree(&worker->deque);
+    worker->active = 0;
+    xmlPool.nbWorkers -= 1;
+    xmlPoolCondBroadcast(&xmlPool.exitCond);
+    POOL_UNLOCK();
+
+    POOL_WORKER_SET(NULL);
+    return(NULL);
+}
+
+/*
+ * Queue a task for the workers, starting a new worker if all of them
+ * are busy. Must be called with the pool lock held.
+ */
+static int
+xmlPoolQueue(xmlTask *task) {
+    xmlPoolWorker *worker = POOL_WORKER_GET();
+    xmlTaskDeque *deque;
+    int i;
+
+    if (xmlPool.size < 0) {
+#ifdef _SC_NPROCESSORS_ONLN
+        long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (nproc > XML_POOL_MAX_WORKERS)
+            nproc = XML_POOL_MAX_WORKERS;
+        xmlPool.size = (nproc > 1) ? nproc : 1;
+#else
+        xmlPool.size = 4;
+#endif
+    }
+
+    if ((xmlPool.stop) || (xmlPool.size == 0))
+        return(-1);
+
+    if ((xmlPool.nbIdle == 0) && (xmlPool.nbWorkers < xmlPool.size)) {
+        for (i = 0; i < xmlPool.size; i++) {
+            xmlPoolWorker *newWorker = &xmlPool.workers[i];
+            pthread_attr_t attr;
+            pthread_t thread;
+            int res;
+
+            if (newWorker->active)
+                continue;
+
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            res = pthread_create(&thread, &attr, xmlPoolWorkerRun,
+                                 newWorker);
+            pthread_attr_destroy(&attr);
+            if (res == 0) {
+                newWorker->active = 1;
+                xmlPool.nbWorkers += 1;
+            }
+            break;
+        }
+    }
+
+    if (xmlPool.nbWorkers == 0)
+        return(-1);
+
+    deque = (worker != NULL) ? &worker->deque : &xmlPool.shared;
+    if (xmlTaskDequePush(deque, task) < 0)
+        return(-1);
+    if (xmlPool.nbIdle > 0)
+        pthread_cond_signal(&xmlPool.cond);
+
+    return(0);
+}
+
+#endif /* HAVE_POSIX_THREADS */
+
+/**
+ * Set the maximum number of worker threads of the library's thread
+ * pool. Workers are started on demand. If the number is reduced,
+ * excess workers exit after finishing their current task.
+ *
+ * With zero workers, tasks are run by the thread joining their group.
+ * The default is the number of online processors.
+ *
+ * Without POSIX threads, there are no workers and this function
+ * only validates its argument.
+ *
+ * @since 2.16.0
+ *
+ * @param nbWorkers  maximum number of worker threads, at most 64
+ * @returns 0 on success or -1 if the number is invalid.
+ */
+int
+xmlThreadPoolSetSize(int nbWorkers) {
+    if ((nbWorkers < 0) || (nbWorkers > XML_POOL_MAX_WORKERS))
+        return(-1);
+
+    xmlInitParser();
+
+    POOL_LOCK();
+    xmlPool.size = nbWorkers;
+#ifdef HAVE_POSIX_THREADS
+    xmlPoolCondBroadcast(&xmlPool.cond);
+#endif
+    POOL_UNLOCK();
+
+    return(0);
+}
+
+/**
+ * Run tasks with an external executor instead of the library's
+ * worker threads, for example to integrate with an application's
+ * scheduler.
+ *
+ * `func` is called with `executor` and a task callback. It must
+ * eventually call the task callback exactly once, with the
+ * argument it was given, on any thread. It returns 0 if it accepted
+ * the task, or -1 to leave the task to the joining thread. Tasks
+ * can already have been run by the thread joining their group when
+ * the callback is invoked. In this case, it returns immediately.
+ *
+ * Pass NULL to use the library's worker threads again. The
+ * executor must not be changed while tasks are pending.
+ *
+ * @since 2.16.0
+ *
+ * @param func  submission callback or NULL
+ * @param executor  user data passed to the callback
+ */
+void
+xmlThreadPoolSetExecutor(xmlTaskExecutorFunc func, void *executor) {
+    xmlInitParser();
+
+    POOL_LOCK();
+    xmlPool.executor = func;
+    xmlPool.executorData = executor;
+    POOL_UNLOCK();
+}
+
+/**
+ * Create a group of tasks which run on the library's thread pool.
+ *
+ * @since 2.16.0
+ *
+ * @returns the new task group or NULL if a memory allocation failed.
+ */
+xmlTaskGroup *
+xmlNewTaskGroup(void) {
+    xmlTaskGroup *group;
+
+    xmlInitParser();
+
+    group = malloc(sizeof(*group));
+    if (group == NULL)
+        return(NULL);
+    memset(group, 0, sizeof(*group));
+    xmlPoolCondInit(&group->cond);
+
+    return(group);
+}
+
+/**
+ * Submit a task to a group. The task runs on a worker thread, on the
+ * external executor or on the thread joining the group.
+ *
+ * Tasks must not block waiting for other tasks of the same group
+ * which haven't started yet. They can create and join other
+ * groups.
+ *
+ * @since 2.16.0
+ *
+ * @param group  the task group
+ * @param func  the function to run
+ * @param arg  argument passed to the function
+ * @returns 0 on success or -1 if a memory allocation failed or the
+ * arguments are invalid.
+ */
+int
+xmlTaskGroupSubmit(xmlTaskGroup *group, xmlTaskFunc func, void *arg) {
+    xmlTaskExecutorFunc executor;
+    void *executorData;
+    xmlTask *task;
+
+    if ((group == NULL) || (func == NULL))
+        return(-1);
+
+    task = malloc(sizeof(*task));
+    if (task == NULL)
+        return(-1);
+    task->func = func;
+    task->arg = arg;
+    task->group = group;
+    task->next = NULL;
+    task->claimed = 0;
+    task->refs = 2;
+
+    POOL_LOCK();
+    task->prev = group->last;
+    if (group->last != NULL)
+        group->last->next = task;
+    else
+        group->first = task;
+    group->last = task;
+    group->pending += 1;
+
+    executor = xmlPool.executor;
+    executorData = xmlPool.executorData;
+#ifdef HAVE_POSIX_THREADS
+    if ((executor == NULL) && (xmlPoolQueue(task) < 0))
+        xmlTaskRelease(task);
+#else
+    if (executor == NULL)
+        xmlTaskRelease(task);
+#endif
+    POOL_UNLOCK();
+
+    if ((executor != NULL) &&
+        (executor(executorData, xmlTaskRunQueued, task) != 0)) {
+        POOL_LOCK();
+        xmlTaskRelease(task);
+        POOL_UNLOCK();
+    }
+
+    return(0);
+}
+
+/**
+ * Wait until all tasks of a group have finished. Tasks which haven't
+ * started yet are run by the calling thread.
+ *
+ * The group can be reused afterwards.
+ *
+ * @since 2.16.0
+ *
+ * @param group  the task group
+ */
+void
+xmlTaskGroupJoin(xmlTaskGroup *group) {
+    if (group == NULL)
+        return;
+
+    POOL_LOCK();
+    while (group->pending > 0) {
+        xmlTask *task = group->first;
+
+        if (task != NULL) {
+            xmlTaskClaim(task);
+            xmlTaskRun(task);
+            continue;
+        }
+
+        xmlPoolCondWait(&group->cond);
+    }
+    POOL_UNLOCK();
+}
+
+/**
+ * Join and free a task group.
+ *
+ * @since 2.16.0
+ *
+ * @param group  the task group
+ */
+void
+xmlFreeTaskGroup(xmlTaskGroup *group) {
+    if (group == NULL)
+        return;
+
+    xmlTaskGroupJoin(group);
+    xmlPoolCondDestroy(&group->cond);
+    free(group);
+}
+
+static void
+xmlInitThreadPoolInternal(void) {
+    xmlInitMutex(&xmlPool.lock);
+#ifdef HAVE_POSIX_THREADS
+    xmlPoolCondInit(&xmlPool.cond);
+    xmlPoolCondInit(&xmlPool.exitCond);
+    xmlPool.stop = 0;
+#endif
+    xmlPool.size = -1;
+    xmlPool.executor = NULL;
+    xmlPool.executorData = NULL;
+}
+
+static void
+xmlCleanupThreadPoolInternal(void) {
+#ifdef HAVE_POSIX_THREADS
+    POOL_LOCK();
+    xmlPool.stop = 1;
+    xmlPoolCondBroadcast(&xmlPool.cond);
+    while (xmlPool.nbWorkers > 0)
+        xmlPoolCondWait(&xmlPool.exitCond);
+    /* Tasks left behind belong to groups which were never joined */
+    while (xmlPool.shared.count > 0)
+        xmlTaskRelease(xmlTaskDequePopTop(&xmlPool.shared));
+    xmlTaskDequeFree(&xmlPool.shared);
+    POOL_UNLOCK();
+
+    xmlPoolCondDestroy(&xmlPool.exitCond);
+    xmlPoolCondDestroy(&xmlPool.cond);
+#endif
+    xmlCleanupMutex(&xmlPool.lock);
+}
+
 /**
  * @deprecated Alias for #xmlInitParser.
  */
@@ -360,13 +1025,21 @@ xmlInitParserInternal(void) {
     xmlInitRandom(); /* Required by xmlInitGlobalsInternal */
     xmlInitMemoryInternal();
     xmlInitThreadsInternal();
+    xmlInitThreadPoolInternal();
     xmlInitGlobalsInternal();
+    xmlInitSimdInternal();
     xmlInitDictInternal();
     xmlInitEncodingInternal();
+    xmlInitConvPoolInternal();
 #if defined(LIBXML_XPATH_ENABLED)
     xmlInitXPathInternal();
 #endif
     xmlInitIOCallbacks();
+    xmlInitResourceCacheInternal();
+    xmlInitDtdCacheInternal();
+#ifdef LIBXML_REGEXP_ENABLED
+    xmlInitRegexpCacheInternal();
+#endif
 #ifdef LIBXML_CATALOG_ENABLED
     xmlInitCatalogInternal();
 #endif
@@ -450,7 +1123,14 @@ xmlCleanupParser(void) {
     if (!xmlParserInitialized)
         return;
 
+    /* Workers may still be running tasks which use the library */
+    xmlCleanupThreadPoolInternal();
+    /* Must be first, pending documents may use other components */
+    xmlCleanupTreeInternal();
     xmlCleanupCharEncodingHandlers();
+    xmlCleanupConvPoolInternal();
+    xmlCleanupDtdCacheInternal();
+    xmlCleanupResourceCacheInternal();
 #ifdef LIBXML_CATALOG_ENABLED
     xmlCatalogCleanup();
     xmlCleanupCatalogInternal();
@@ -469,7 +1149,14 @@ xmlCleanupParser(void) {
 #ifdef LIBXML_RELAXNG_ENABLED
     xmlCleanupRelaxNGInternal();
 #endif
+#ifdef LIBXML_REGEXP_ENABLED
+    /* Must be after the schema and RelaxNG cleanup */
+    xmlCleanupRegexpCacheInternal();
+#endif
 
+#if defined(LIBXML_XPATH_ENABLED)
+    xmlCleanupXPathInternal();
+#endif
     xmlCleanupDictInternal();
     xmlCleanupRandom();
     xmlCleanupGlobalsInternal();
@@ -155,6 +155,9 @@ static __inline int compute_minrun(const uint64_t size) {
 #define TIM_SORT_RESIZE                SORT_MAKE_STR(tim_sort_resize)
 #define TIM_SORT_MERGE                 SORT_MAKE_STR(tim_sort_merge)
 #define TIM_SORT_COLLAPSE              SORT_MAKE_STR(tim_sort_collapse)
+#define TIM_SORT_RUN_T                 SORT_MAKE_STR(tim_sort_run_t)
+#define TEMP_STORAGE_T                 SORT_MAKE_STR(temp_storage_t)
+#define PUSH_NEXT                      SORT_MAKE_STR(push_next)
 
 #ifndef MAX
 #define MAX(x,y) (((x) > (y) ? (x) : (y)))
@@ -0,0 +1,97 @@
+/*
+ * trace.c: tracing hooks
+ *
+ * The handler is checked through a plain global flag, so disabled
+ * tracing costs a load and a branch per traced phase. Timestamps are
+ * only taken while a handler is registered. USDT probes, if compiled
+ * in, are a no-op instruction until a tracer attaches.
+ *
+ * See Copyright for the status of this software.
+ */
+
+#define IN_LIBXML
+#include "libxml.h"
+
+#include <time.h>
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#endif
+
+#include "private/trace.h"
+
+int xmlTraceActive;
+
+static xmlTraceFunc xmlTraceHandler;
+static void *xmlTraceData;
+
+/**
+ * Register a process-wide handler for trace events or disable
+ * tracing by passing NULL. The handler is shared by all threads, so
+ * it should be set before other threads start using the library.
+ *
+ * @since 2.16.0
+ *
+ * @param handler  the handler or NULL
+ * @param userData  user data passed to the handler
+ */
+void
+xmlTraceSetHandler(xmlTraceFunc handler, void *userData) {
+    xmlTraceActive = 0;
+    xmlTraceHandler = handler;
+    xmlTraceData = userData;
+    xmlTraceActive = (handler != NULL);
+}
+
+/**
+ * @returns a monotonic time in seconds.
+ */
+double
+xmlTraceTime(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return((double) count.QuadPart / (double) freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return(0.0);
+    return((double) ts.tv_sec + (double) ts.tv_nsec / 1e9);
+#else
+    return((double) clock() / CLOCKS_PER_SEC);
+#endif
+}
+
+/**
+ * Report an event to the handler.
+ *
+ * @param event  the event
+ * @param name  URL, expression or NULL
+ * @param bytes  byte count or -1
+ * @param start  start time from xmlTraceTime or 0
+ */
+void
+xmlTraceEmit(xmlTraceEvent event, const char *name, long bytes,
+             double start) {
+    xmlTraceFunc handler = xmlTraceHandler;
+    xmlTraceInfo info;
+
+    if (handler == NULL)
+        return;
+
+    info.event = event;
+    info.name = name;
+    info.bytes = bytes;
+    info.duration = 0.0;
+    if (start > 0.0) {
+        info.duration = xmlTraceTime() - start;
+        if (info.duration < 0.0)
+            info.duration = 0.0;
+    }
+
+    handler(xmlTraceData, &info);
+}
@@ -39,14 +39,22 @@
 #include <libxml/HTMLtree.h>
 #endif
 
+#include "private/binary.h"
 #include "private/buf.h"
+#include "private/dict.h"
 #include "private/entities.h"
 #include "private/error.h"
 #include "private/memory.h"
 #include "private/io.h"
 #include "private/parser.h"
+#include "private/threads.h"
 #include "private/tree.h"
 
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #include <pthread.h>
+  #define XML_TREE_RECLAIMER
+#endif
+
 #ifndef SIZE_MAX
   #define SIZE_MAX ((size_t) -1)
 #endif
@@ -76,12 +84,41 @@ xmlGetPropNodeInternal(const xmlNode *node, const xmlChar *name,
 
 static xmlChar* xmlGetPropNodeValueInternal(const xmlAttr *prop);
 
-static void
-xmlBufGetChildContent(xmlBufPtr buf, const xmlNode *tree);
+static int
+xmlNodeWalkChildren(const xmlNode *tree, xmlNodeContentFunc func,
+                    void *ctxt);
+
+static xmlChar *
+xmlNodeConcatContent(const xmlNode *node, int list);
 
 static void
 xmlUnlinkNodeInternal(xmlNodePtr cur);
 
+static void
+xmlDocIndexInvalidate(xmlDocPtr doc);
+
+static void
+xmlDocIndexRemoved(xmlNodePtr node);
+
+static void
+xmlDocIndexOrderChanged(xmlDocPtr doc);
+
+static void
+xmlDocIndexInvalidateValues(xmlDocPtr doc);
+
+static void
+xmlDocIndexAttrChanged(xmlNodePtr node);
+static void
+xmlNodeSourceChanged(xmlNodePtr node);
+static void
+xmlNodeSourceForget(xmlDocPtr doc, xmlNodePtr node);
+
+static xmlNsPtr
+xmlTreeEnsureXMLDecl(xmlDocPtr doc);
+
+static void
+xmlDocUnmapImage(xmlDocPtr doc);
+
 /************************************************************************
  *									*
  *		A few static variables and macros			*
@@ -533,6 +570,9 @@ xmlNewNs(xmlNode *node, const xmlChar *href, const xmlChar *prefix) {
 	cur->href = xmlStrdup(href);
         if (cur->href == NULL)
             goto error;
+        /* Register the URI for lookups, see xmlNsIdCacheGet */
+        if ((node != NULL) && (node->doc != NULL))
+            xmlDictNsId(node->doc->dict, href, 1);
     }
     if (prefix != NULL) {
 	cur->prefix = xmlStrdup(prefix);
@@ -561,6 +601,7 @@ xmlNewNs(xmlNode *node, const xmlChar *href, const xmlChar *prefix) {
 	    }
 	    prev->next = cur;
 	}
+        xmlNodeSourceChanged(node);
     }
     return(cur);
 
@@ -581,9 +622,14 @@ xmlSetNs(xmlNode *node, xmlNs *ns) {
     if (node == NULL) {
 	return;
     }
-    if ((node->type == XML_ELEMENT_NODE) ||
-        (node->type == XML_ATTRIBUTE_NODE))
+    xmlNodeSourceChanged(node);
+    if (node->type == XML_ELEMENT_NODE) {
+        xmlDocIndexInvalidate(node->doc);
+	node->ns = ns;
+    } else if (node->type == XML_ATTRIBUTE_NODE) {
+        xmlDocIndexAttrChanged(node);
 	node->ns = ns;
+    }
 }
 
 /**
@@ -811,6 +857,65 @@ error:
 	    (xmlDictOwns(dict, (const xmlChar *)(str)) == 0)))	\
 	    xmlFree((char *)(str));
 
+/**
+ * Free node content if it is neither owned by the "dict" dictionary
+ * nor by the arena of the document `doc`
+ *
+ * @param doc  a document (optional)
+ * @param str  a string
+ */
+#define CONTENT_FREE(doc, str)					\
+	if ((str) && (((doc) == NULL) ||			\
+	    (!xmlArenaOwns((doc)->arena, (str))))) {		\
+	    DICT_FREE(str)					\
+	}
+
+/**
+ * Allocate memory for a node of a document. If the document was
+ * parsed with XML_PARSE_ARENA, the memory is taken from the
+ * document's arena.
+ *
+ * @param doc  the document (optional)
+ * @param size  number of bytes
+ * @returns a pointer to the memory or NULL if a memory allocation
+ * failed.
+ */
+void *
+xmlTreeAlloc(xmlDoc *doc, size_t size) {
+    if ((doc != NULL) && (doc->arena != NULL))
+        return(xmlArenaAlloc(doc->arena, size));
+    return(xmlMalloc(size));
+}
+
+/**
+ * Duplicate a string for use as node content, see #xmlTreeAlloc.
+ *
+ * @param doc  the document (optional)
+ * @param str  the string
+ * @param len  length of the string
+ * @returns the copy or NULL if a memory allocation failed.
+ */
+xmlChar *
+xmlTreeStrndup(xmlDoc *doc, const xmlChar *str, int len) {
+    if ((doc != NULL) && (doc->arena != NULL))
+        return(xmlArenaStrndup(doc->arena, str, len));
+    return(xmlStrndup(str, len));
+}
+
+/**
+ * Free memory returned by #xmlTreeAlloc or #xmlTreeStrndup. Arena
+ * memory is only released together with the document.
+ *
+ * @param doc  the document (optional)
+ * @param mem  the memory
+ */
+void
+xmlTreeFree(xmlDoc *doc, void *mem) {
+    if ((doc != NULL) && (xmlArenaOwns(doc->arena, mem)))
+        return;
+    xmlFree(mem);
+}
+
 /**
  * Free a DTD structure.
  *
@@ -923,16 +1028,25 @@ void
 xmlFreeDoc(xmlDoc *cur) {
     xmlDtdPtr extSubset, intSubset;
     xmlDictPtr dict = NULL;
+    xmlArena *arena;
 
     if (cur == NULL) {
 	return;
     }
 
+    if (cur->properties & XML_DOC_IMAGE) {
+        xmlDocUnmapImage(cur);
+        return;
+    }
+
     dict = cur->dict;
 
     if ((xmlRegisterCallbacks) && (xmlDeregisterNodeDefaultValue))
 	xmlDeregisterNodeDefaultValue((xmlNodePtr)cur);
 
+    xmlDocSetNameIndex(cur, 0);
+    xmlDocDiscardSource(cur);
+
     /*
      * Do this before freeing the children list to avoid ID lookups
      */
@@ -940,6 +1054,7 @@ xmlFreeDoc(xmlDoc *cur) {
     cur->ids = NULL;
     if (cur->refs != NULL) xmlFreeRefTable((xmlRefTablePtr) cur->refs);
     cur->refs = NULL;
+    xmlDtdCacheRelease(cur);
     extSubset = cur->extSubset;
     intSubset = cur->intSubset;
     if (intSubset == extSubset)
@@ -967,8 +1082,252 @@ xmlFreeDoc(xmlDoc *cur) {
     if (cur->URL != NULL)
         xmlFree(cur->URL);
 
+    arena = cur->arena;
     xmlFree(cur);
     if (dict) xmlDictFree(dict);
+    xmlArenaFree(arena);
+}
+
+/**
+ * Free a document in slices. Each call frees at most `maxNodes`
+ * nodes of the document tree, starting with the leaves, so that the
+ * work of releasing a large document can be spread over time. Once
+ * all nodes are freed, the document itself is freed with #xmlFreeDoc
+ * and 0 is returned.
+ *
+ * After the first call, the document must only be passed to this
+ * function until it returns 0. Between calls, the remaining tree is
+ * consistent but its contents are undefined.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  the document
+ * @param maxNodes  maximum number of nodes to free in this call
+ * @returns 1 if nodes remain to be freed, 0 if the document was
+ * freed or -1 if arguments are invalid.
+ */
+int
+xmlFreeDocIncremental(xmlDoc *doc, int maxNodes) {
+    xmlNodePtr parent, cur;
+    int nb = 0;
+
+    if ((doc == NULL) || (maxNodes <= 0))
+        return(-1);
+
+    /* Avoid ID lookups and index updates like xmlFreeDoc */
+    xmlDocSetNameIndex(doc, 0);
+    xmlDocDiscardSource(doc);
+    if (doc->ids != NULL) xmlFreeIDTable((xmlIDTablePtr) doc->ids);
+    doc->ids = NULL;
+    if (doc->refs != NULL) xmlFreeRefTable((xmlRefTablePtr) doc->refs);
+    doc->refs = NULL;
+
+    parent = (xmlNodePtr) doc;
+    while (nb < maxNodes) {
+        /* DTDs are left to xmlFreeDoc */
+        cur = parent->children;
+        while ((cur != NULL) && (cur->type == XML_DTD_NODE))
+            cur = cur->next;
+
+        if (cur == NULL) {
+            if (parent == (xmlNodePtr) doc) {
+                xmlFreeDoc(doc);
+                return(0);
+            }
+            cur = parent;
+            parent = parent->parent;
+        } else if ((cur->children != NULL) &&
+                   (cur->type != XML_ENTITY_REF_NODE)) {
+            parent = cur;
+            continue;
+        }
+
+        if (cur->prev != NULL)
+            cur->prev->next = cur->next;
+        else
+            parent->children = cur->next;
+        if (cur->next != NULL)
+            cur->next->prev = cur->prev;
+        else
+            parent->last = cur->prev;
+        cur->parent = NULL;
+        cur->prev = NULL;
+        cur->next = NULL;
+        xmlFreeNode(cur);
+        nb++;
+    }
+
+    return(1);
+}
+
+#ifdef XML_TREE_RECLAIMER
+static pthread_mutex_t xmlReclaimMutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signaled when documents were queued or the thread should stop */
+static pthread_cond_t xmlReclaimCond = PTHREAD_COND_INITIALIZER;
+/* Signaled when a batch of documents was freed */
+static pthread_cond_t xmlReclaimDoneCond = PTHREAD_COND_INITIALIZER;
+static pthread_t xmlReclaimThread;
+static int xmlReclaimRunning;
+static int xmlReclaimStop;
+static int xmlReclaimBusy;
+static xmlDocPtr *xmlReclaimQueue;
+static int xmlReclaimNr;
+static int xmlReclaimMax;
+
+static void *
+xmlReclaimMain(void *arg ATTRIBUTE_UNUSED) {
+    xmlDocPtr *batch;
+    int nb, i;
+
+    pthread_mutex_lock(&xmlReclaimMutex);
+    while (1) {
+        while ((xmlReclaimNr == 0) && (!xmlReclaimStop))
+            pthread_cond_wait(&xmlReclaimCond, &xmlReclaimMutex);
+        if (xmlReclaimNr == 0)
+            break;
+
+        batch = xmlReclaimQueue;
+        nb = xmlReclaimNr;
+        xmlReclaimQueue = NULL;
+        xmlReclaimNr = 0;
+        xmlReclaimMax = 0;
+        xmlReclaimBusy = 1;
+        pthread_mutex_unlock(&xmlReclaimMutex);
+
+        for (i = 0; i < nb; i++)
+            xmlFreeDoc(batch[i]);
+        xmlFree(batch);
+
+        pthread_mutex_lock(&xmlReclaimMutex);
+        xmlReclaimBusy = 0;
+        pthread_cond_broadcast(&xmlReclaimDoneCond);
+    }
+    pthread_mutex_unlock(&xmlReclaimMutex);
+
+    return(NULL);
+}
+
+static int
+xmlReclaimPush(xmlDocPtr doc) {
+    int ret = -1;
+
+    pthread_mutex_lock(&xmlReclaimMutex);
+
+    if (!xmlReclaimRunning) {
+        if (pthread_create(&xmlReclaimThread, NULL, xmlReclaimMain,
+                           NULL) != 0)
+            goto done;
+        xmlReclaimRunning = 1;
+    }
+
+    if (xmlReclaimNr >= xmlReclaimMax) {
+        xmlDocPtr *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(xmlReclaimMax, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            goto done;
+        tmp = xmlRealloc(xmlReclaimQueue, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto done;
+        xmlReclaimQueue = tmp;
+        xmlReclaimMax = newSize;
+    }
+
+    xmlReclaimQueue[xmlReclaimNr++] = doc;
+    pthread_cond_signal(&xmlReclaimCond);
+    ret = 0;
+
+done:
+    pthread_mutex_unlock(&xmlReclaimMutex);
+    return(ret);
+}
+#endif /* XML_TREE_RECLAIMER */
+
+/**
+ * Free a document on a background thread. The call returns
+ * immediately and the document is handed to a reclaimer thread
+ * which is started on first use. The caller must not access the
+ * document afterwards.
+ *
+ * The dictionary of the document can still be used by other
+ * documents and parsers while the document is freed. Its reference
+ * count is updated safely from the reclaimer thread.
+ *
+ * The document is freed synchronously with #xmlFreeDoc if threads
+ * aren't supported, if node deregistration callbacks are in use
+ * or if a memory allocation failed.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  the document
+ */
+void
+xmlFreeDocAsync(xmlDoc *doc) {
+#ifdef XML_TREE_RECLAIMER
+    if (doc == NULL)
+        return;
+
+    /* Callbacks are thread-local */
+    if (xmlRegisterCallbacks)
+        goto sync;
+
+    /*
+     * The dictionary may still be modified by this thread. Ownership
+     * checks in the reclaimer use a view of the current strings.
+     */
+    if (doc->dict != NULL) {
+        xmlDictPtr view = xmlDictNewView(doc->dict);
+
+        if (view == NULL)
+            goto sync;
+        xmlDictFree(doc->dict);
+        doc->dict = view;
+    }
+
+    if (xmlReclaimPush(doc) == 0)
+        return;
+
+sync:
+#endif
+    xmlFreeDoc(doc);
+}
+
+/**
+ * Wait until all documents passed to #xmlFreeDocAsync were freed.
+ *
+ * @since 2.16.0
+ */
+void
+xmlFreeDocAsyncWait(void) {
+#ifdef XML_TREE_RECLAIMER
+    pthread_mutex_lock(&xmlReclaimMutex);
+    while ((xmlReclaimNr > 0) || (xmlReclaimBusy))
+        pthread_cond_wait(&xmlReclaimDoneCond, &xmlReclaimMutex);
+    pthread_mutex_unlock(&xmlReclaimMutex);
+#endif
+}
+
+/**
+ * Free pending documents and stop the reclaimer thread.
+ */
+void
+xmlCleanupTreeInternal(void) {
+#ifdef XML_TREE_RECLAIMER
+    pthread_mutex_lock(&xmlReclaimMutex);
+    if (!xmlReclaimRunning) {
+        pthread_mutex_unlock(&xmlReclaimMutex);
+        return;
+    }
+    xmlReclaimStop = 1;
+    pthread_cond_signal(&xmlReclaimCond);
+    pthread_mutex_unlock(&xmlReclaimMutex);
+
+    pthread_join(xmlReclaimThread, NULL);
+    xmlReclaimRunning = 0;
+    xmlReclaimStop = 0;
+#endif
 }
 
 /**
@@ -1310,6 +1669,9 @@ xmlNodeListGetStringInternal(const xmlNode *node, int escape, int flags) {
         return(xmlStrdup(node->content));
     }
 
+    if (escape == 0)
+        return(xmlNodeConcatContent(node, 1));
+
     buf = xmlBufCreate(50);
     if (buf == NULL)
         return(NULL);
@@ -1318,26 +1680,20 @@ xmlNodeListGetStringInternal(const xmlNode *node, int escape, int flags) {
         if ((node->type == XML_TEXT_NODE) ||
             (node->type == XML_CDATA_SECTION_NODE)) {
             if (node->content != NULL) {
-                if (escape == 0) {
-                    xmlBufCat(buf, node->content);
-                } else {
-                    xmlChar *encoded;
+                xmlChar *encoded;
 
-                    encoded = xmlEscapeText(node->content, flags);
-                    if (encoded == NULL)
-                        goto error;
-                    xmlBufCat(buf, encoded);
+                encoded = xmlEscapeText(node->content,
+                                        flags | XML_ESCAPE_NO_COPY);
+                if (encoded == NULL)
+                    goto error;
+                xmlBufCat(buf, encoded);
+                if (encoded != node->content)
                     xmlFree(encoded);
-                }
             }
         } else if (node->type == XML_ENTITY_REF_NODE) {
-            if (escape == 0) {
-                xmlBufGetNodeContent(buf, node);
-            } else {
-                xmlBufAdd(buf, BAD_CAST "&", 1);
-                xmlBufCat(buf, node->name);
-                xmlBufAdd(buf, BAD_CAST ";", 1);
-            }
+            xmlBufAdd(buf, BAD_CAST "&", 1);
+            xmlBufCat(buf, node->name);
+            xmlBufAdd(buf, BAD_CAST ";", 1);
         }
 
         node = node->next;
@@ -1463,6 +1819,9 @@ xmlNewPropInternal(xmlNodePtr node, xmlNsPtr ns,
     if (node != NULL) {
         doc = node->doc;
         cur->doc = doc;
+        xmlDocIndexAttrChanged((xmlNodePtr) cur);
+        xmlDocIndexOrderChanged(doc);
+        xmlNodeSourceChanged(node);
     }
     cur->ns = ns;
 
@@ -1690,13 +2049,18 @@ xmlFreeProp(xmlAttr *cur) {
     if ((xmlRegisterCallbacks) && (xmlDeregisterNodeDefaultValue))
 	xmlDeregisterNodeDefaultValue((xmlNodePtr)cur);
 
+    if (cur->parent != NULL) {
+        xmlDocIndexOrderChanged(cur->doc);
+        xmlNodeSourceChanged(cur->parent);
+    }
+
     /* Check for ID removal -> leading to invalid references ! */
     if (cur->doc != NULL && cur->id != NULL) {
         xmlRemoveID(cur->doc, cur);
     }
     if (cur->children != NULL) xmlFreeNodeList(cur->children);
     DICT_FREE(cur->name)
-    xmlFree(cur);
+    xmlTreeFree(cur->doc, cur);
 }
 
 /**
@@ -1842,7 +2206,7 @@ xmlNewElem(xmlDocPtr doc, xmlNsPtr ns, const xmlChar *name,
            const xmlChar *content) {
     xmlNodePtr cur;
 
-    cur = (xmlNodePtr) xmlMalloc(sizeof(xmlNode));
+    cur = (xmlNodePtr) xmlTreeAlloc(doc, sizeof(xmlNode));
     if (cur == NULL)
 	return(NULL);
     memset(cur, 0, sizeof(xmlNode));
@@ -1860,7 +2224,7 @@ xmlNewElem(xmlDocPtr doc, xmlNsPtr ns, const xmlChar *name,
         if (xmlNodeParseAttValue(doc, (xmlAttr *) cur, content, SIZE_MAX,
                                  NULL) < 0) {
             /* Don't free name on error */
-            xmlFree(cur);
+            xmlTreeFree(doc, cur);
             return(NULL);
         }
     }
@@ -2105,6 +2469,9 @@ xmlNewTextChild(xmlNode *parent, xmlNs *ns,
     if (cur == NULL)
         return(NULL);
 
+    xmlDocIndexInvalidate(parent->doc);
+    xmlNodeSourceChanged(parent);
+
     /*
      * add the new element at the end of the children list.
      */
@@ -2383,7 +2750,7 @@ xmlNewCDataBlock(xmlDoc *doc, const xmlChar *content, int len) {
     /*
      * Allocate a new node and fill the fields.
      */
-    cur = (xmlNodePtr) xmlMalloc(sizeof(xmlNode));
+    cur = (xmlNodePtr) xmlTreeAlloc(doc, sizeof(xmlNode));
     if (cur == NULL)
 	return(NULL);
     memset(cur, 0, sizeof(xmlNode));
@@ -2391,9 +2758,9 @@ xmlNewCDataBlock(xmlDoc *doc, const xmlChar *content, int len) {
     cur->doc = doc;
 
     if (content != NULL) {
-	cur->content = xmlStrndup(content, len);
+	cur->content = xmlTreeStrndup(doc, content, len);
         if (cur->content == NULL) {
-            xmlFree(cur);
+            xmlTreeFree(doc, cur);
             return(NULL);
         }
     }
@@ -2493,6 +2860,16 @@ xmlNodeSetDoc(xmlNodePtr node, xmlDocPtr doc) {
         }
     }
 
+    if ((oldDoc != NULL) && (oldDoc != doc) &&
+        (node->content != NULL) &&
+        ((node->type == XML_TEXT_NODE) ||
+         (node->type == XML_CDATA_SECTION_NODE)) &&
+        (xmlArenaOwns(oldDoc->arena, node->content))) {
+        node->content = xmlStrdup(node->content);
+        if (node->content == NULL)
+            ret = -1;
+    }
+
     switch (node->type) {
         case XML_ATTRIBUTE_NODE: {
             xmlAttrPtr attr = (xmlAttrPtr) node;
@@ -2558,6 +2935,9 @@ xmlNodeSetDoc(xmlNodePtr node, xmlDocPtr doc) {
             break;
     }
 
+    if ((oldDoc != doc) && (node->type == XML_ELEMENT_NODE))
+        xmlNodeSourceForget(oldDoc, node);
+
     /*
      * Set new document
      */
@@ -2566,25 +2946,11 @@ xmlNodeSetDoc(xmlNodePtr node, xmlDocPtr doc) {
     return(ret);
 }
 
-/**
- * Associate all nodes in a tree with a new document.
- *
- * This is an internal function which shouldn't be used. It is
- * invoked by functions like #xmlAddChild, #xmlAddSibling or
- * #xmlReplaceNode. `tree` must be the root node of an unlinked
- * subtree.
- *
- * Also copy strings from the old document's dictionary and
- * remove ID attributes from the old ID table.
- *
- * @param tree  root of a subtree
- * @param doc  new document
- * @returns 0 on success. If a memory allocation fails, returns -1.
- * The whole tree will be updated on failure but some strings
- * may be lost.
- */
-int
-xmlSetTreeDoc(xmlNode *tree, xmlDoc *doc) {
+static int
+xmlSetListDocInternal(xmlNodePtr list, xmlDocPtr doc);
+
+static int
+xmlSetTreeDocInternal(xmlNodePtr tree, xmlDocPtr doc) {
     int ret = 0;
 
     if ((tree == NULL) || (tree->type == XML_NAMESPACE_DECL))
@@ -2597,7 +2963,7 @@ xmlSetTreeDoc(xmlNode *tree, xmlDoc *doc) {
 
         while (prop != NULL) {
             if (prop->children != NULL) {
-                if (xmlSetListDoc(prop->children, doc) < 0)
+                if (xmlSetListDocInternal(prop->children, doc) < 0)
                     ret = -1;
             }
 
@@ -2610,7 +2976,7 @@ xmlSetTreeDoc(xmlNode *tree, xmlDoc *doc) {
 
     if ((tree->children != NULL) &&
         (tree->type != XML_ENTITY_REF_NODE)) {
-        if (xmlSetListDoc(tree->children, doc) < 0)
+        if (xmlSetListDocInternal(tree->children, doc) < 0)
             ret = -1;
     }
 
@@ -2620,19 +2986,8 @@ xmlSetTreeDoc(xmlNode *tree, xmlDoc *doc) {
     return(ret);
 }
 
-/**
- * Associate all subtrees in `list` with a new document.
- *
- * Internal function, see #xmlSetTreeDoc.
- *
- * @param list  a node list
- * @param doc  new document
- * @returns 0 on success. If a memory allocation fails, returns -1.
- * All subtrees will be updated on failure but some strings
- * may be lost.
- */
-int
-xmlSetListDoc(xmlNode *list, xmlDoc *doc) {
+static int
+xmlSetListDocInternal(xmlNodePtr list, xmlDocPtr doc) {
     xmlNodePtr cur;
     int ret = 0;
 
@@ -2642,7 +2997,7 @@ xmlSetListDoc(xmlNode *list, xmlDoc *doc) {
     cur = list;
     while (cur != NULL) {
 	if (cur->doc != doc) {
-	    if (xmlSetTreeDoc(cur, doc) < 0)
+	    if (xmlSetTreeDocInternal(cur, doc) < 0)
                 ret = -1;
         }
 	cur = cur->next;
@@ -2651,77 +3006,185 @@ xmlSetListDoc(xmlNode *list, xmlDoc *doc) {
     return(ret);
 }
 
-/**
- * Create a new child element and append it to a parent element.
- *
- * If `ns` is NULL, the newly created element inherits the namespace
- * of the parent.
- *
- * If provided, `content` is expected to be a valid XML attribute
- * value possibly containing character and entity references. Text
- * and entity reference node will be added to the child element,
- * see #xmlNewDocNode.
- *
- * @param parent  the parent node
- * @param ns  a namespace (optional)
- * @param name  the name of the child
- * @param content  text content with XML references (optional)
- * @returns a pointer to the new node object or NULL if arguments
- * are invalid or a memory allocation failed.
+/*
+ * Check whether any node of a subtree was allocated from `arena`.
  */
-xmlNode *
-xmlNewChild(xmlNode *parent, xmlNs *ns,
-            const xmlChar *name, const xmlChar *content) {
-    xmlNodePtr cur, prev;
-
-    if ((parent == NULL) || (name == NULL))
-	return(NULL);
+static int
+xmlTreeInArena(const xmlNode *tree, const xmlArena *arena) {
+    const xmlNode *cur;
 
-    switch (parent->type) {
-        case XML_DOCUMENT_NODE:
-        case XML_HTML_DOCUMENT_NODE:
-        case XML_DOCUMENT_FRAG_NODE:
-            break;
+    if (xmlArenaOwns(arena, tree))
+        return(1);
 
-        case XML_ELEMENT_NODE:
-            if (ns == NULL)
-                ns = parent->ns;
-            break;
+    if (tree->type == XML_ELEMENT_NODE) {
+        const xmlAttr *prop;
 
-        default:
-            return(NULL);
+        for (prop = tree->properties; prop != NULL; prop = prop->next) {
+            if (xmlTreeInArena((const xmlNode *) prop, arena))
+                return(1);
+        }
     }
 
-    cur = xmlNewDocNode(parent->doc, ns, name, content);
-    if (cur == NULL)
-        return(NULL);
+    if (tree->type == XML_ENTITY_REF_NODE)
+        return(0);
 
-    /*
-     * add the new element at the end of the children list.
-     */
-    cur->parent = parent;
-    if (parent->children == NULL) {
-        parent->children = cur;
-	parent->last = cur;
-    } else {
-        prev = parent->last;
-	prev->next = cur;
-	cur->prev = prev;
-	parent->last = cur;
+    for (cur = tree->children; cur != NULL; cur = cur->next) {
+        if (xmlTreeInArena(cur, arena))
+            return(1);
     }
 
-    return(cur);
+    return(0);
+}
+
+/*
+ * Nodes allocated from the arena of a document are released together
+ * with that document, so they must not be moved to another one.
+ *
+ * Returns 1 if the subtree `tree` can be moved to `doc`.
+ */
+static int
+xmlTreeCanMove(const xmlNode *tree, const xmlDoc *doc) {
+    if ((tree == NULL) || (tree->type == XML_NAMESPACE_DECL) ||
+        (tree->doc == doc) || (tree->doc == NULL) ||
+        (tree->doc->arena == NULL))
+        return(1);
+
+    return(!xmlTreeInArena(tree, tree->doc->arena));
+}
+
+/**
+ * Associate all nodes in a tree with a new document.
+ *
+ * This is an internal function which shouldn't be used. It is
+ * invoked by functions like #xmlAddChild, #xmlAddSibling or
+ * #xmlReplaceNode. `tree` must be the root node of an unlinked
+ * subtree.
+ *
+ * Also copy strings from the old document's dictionary and
+ * remove ID attributes from the old ID table.
+ *
+ * Nodes allocated from the arena of their document (see
+ * XML_PARSE_ARENA) can't be moved to another document. The tree
+ * is left unchanged in this case.
+ *
+ * @param tree  root of a subtree
+ * @param doc  new document
+ * @returns 0 on success, -1 if the tree contains arena nodes or if
+ * a memory allocation fails. The whole tree will be updated on
+ * allocation failure but some strings may be lost.
+ */
+int
+xmlSetTreeDoc(xmlNode *tree, xmlDoc *doc) {
+    if (!xmlTreeCanMove(tree, doc))
+        return(-1);
+
+    return(xmlSetTreeDocInternal(tree, doc));
+}
+
+/**
+ * Associate all subtrees in `list` with a new document.
+ *
+ * Internal function, see #xmlSetTreeDoc.
+ *
+ * @param list  a node list
+ * @param doc  new document
+ * @returns 0 on success, -1 if the list contains arena nodes or if
+ * a memory allocation fails. All subtrees will be updated on
+ * allocation failure but some strings may be lost.
+ */
+int
+xmlSetListDoc(xmlNode *list, xmlDoc *doc) {
+    xmlNodePtr cur;
+
+    if ((list == NULL) || (list->type == XML_NAMESPACE_DECL))
+	return(0);
+
+    for (cur = list; cur != NULL; cur = cur->next) {
+        if (!xmlTreeCanMove(cur, doc))
+            return(-1);
+    }
+
+    return(xmlSetListDocInternal(list, doc));
+}
+
+/**
+ * Create a new child element and append it to a parent element.
+ *
+ * If `ns` is NULL, the newly created element inherits the namespace
+ * of the parent.
+ *
+ * If provided, `content` is expected to be a valid XML attribute
+ * value possibly containing character and entity references. Text
+ * and entity reference node will be added to the child element,
+ * see #xmlNewDocNode.
+ *
+ * @param parent  the parent node
+ * @param ns  a namespace (optional)
+ * @param name  the name of the child
+ * @param content  text content with XML references (optional)
+ * @returns a pointer to the new node object or NULL if arguments
+ * are invalid or a memory allocation failed.
+ */
+xmlNode *
+xmlNewChild(xmlNode *parent, xmlNs *ns,
+            const xmlChar *name, const xmlChar *content) {
+    xmlNodePtr cur, prev;
+
+    if ((parent == NULL) || (name == NULL))
+	return(NULL);
+
+    switch (parent->type) {
+        case XML_DOCUMENT_NODE:
+        case XML_HTML_DOCUMENT_NODE:
+        case XML_DOCUMENT_FRAG_NODE:
+            break;
+
+        case XML_ELEMENT_NODE:
+            if (ns == NULL)
+                ns = parent->ns;
+            break;
+
+        default:
+            return(NULL);
+    }
+
+    cur = xmlNewDocNode(parent->doc, ns, name, content);
+    if (cur == NULL)
+        return(NULL);
+
+    xmlDocIndexInvalidate(parent->doc);
+    xmlNodeSourceChanged(parent);
+
+    /*
+     * add the new element at the end of the children list.
+     */
+    cur->parent = parent;
+    if (parent->children == NULL) {
+        parent->children = cur;
+	parent->last = cur;
+    } else {
+        prev = parent->last;
+	prev->next = cur;
+	cur->prev = prev;
+	parent->last = cur;
+    }
+
+    return(cur);
 }
 
 static void
 xmlTextSetContent(xmlNodePtr text, xmlChar *content) {
+    xmlDocIndexAttrChanged(text);
+    xmlNodeSourceChanged(text);
+
     if ((text->content != NULL) &&
         (text->content != (xmlChar *) &text->properties)) {
         xmlDocPtr doc = text->doc;
 
         if ((doc == NULL) ||
-            (doc->dict == NULL) ||
-            (!xmlDictOwns(doc->dict, text->content)))
+            (((doc->dict == NULL) ||
+              (!xmlDictOwns(doc->dict, text->content))) &&
+             (!xmlArenaOwns(doc->arena, text->content))))
             xmlFree(text->content);
     }
 
@@ -2758,9 +3221,12 @@ xmlInsertProp(xmlDocPtr doc, xmlNodePtr cur, xmlNodePtr parent,
                                   cur->ns ? cur->ns->href : NULL, 0);
 
     xmlUnlinkNodeInternal(cur);
+    xmlDocIndexInvalidateValues(doc);
+    xmlDocIndexOrderChanged(doc);
+    xmlNodeSourceChanged(parent);
 
     if (cur->doc != doc) {
-        if (xmlSetTreeDoc(cur, doc) < 0)
+        if (xmlSetTreeDocInternal(cur, doc) < 0)
             return(NULL);
     }
 
@@ -2791,9 +3257,17 @@ xmlInsertNode(xmlDocPtr doc, xmlNodePtr cur, xmlNodePtr parent,
               xmlNodePtr prev, xmlNodePtr next, int coalesce) {
     xmlNodePtr oldParent;
 
+    if (!xmlTreeCanMove(cur, doc))
+        return(NULL);
+
     if (cur->type == XML_ATTRIBUTE_NODE)
 	return xmlInsertProp(doc, cur, parent, prev, next);
 
+    if ((parent != NULL) && (parent->type == XML_ATTRIBUTE_NODE))
+        xmlDocIndexInvalidateValues(doc);
+    xmlDocIndexAttrChanged(cur);
+    xmlNodeSourceChanged(parent);
+
     /*
      * Coalesce text nodes
      */
@@ -2824,6 +3298,14 @@ xmlInsertNode(xmlDocPtr doc, xmlNodePtr cur, xmlNodePtr parent,
 	}
     }
 
+    if (cur->type == XML_ELEMENT_NODE) {
+        xmlDocIndexInvalidate(cur->doc);
+        xmlDocIndexInvalidate(doc);
+    } else {
+        xmlDocIndexOrderChanged(cur->doc);
+        xmlDocIndexOrderChanged(doc);
+    }
+
     /* Unlink */
     oldParent = cur->parent;
     if (oldParent != NULL) {
@@ -2838,7 +3320,7 @@ xmlInsertNode(xmlDocPtr doc, xmlNodePtr cur, xmlNodePtr parent,
         cur->prev->next = cur->next;
 
     if (cur->doc != doc) {
-	if (xmlSetTreeDoc(cur, doc) < 0) {
+	if (xmlSetTreeDocInternal(cur, doc) < 0) {
             /*
              * We shouldn't make any modifications to the inserted
              * tree if a memory allocation fails, but that's hard to
@@ -2997,16 +3479,24 @@ xmlAddChildList(xmlNode *parent, xmlNode *cur) {
 	return(NULL);
     }
 
+    for (iter = cur; iter != NULL; iter = iter->next) {
+        if (!xmlTreeCanMove(iter, parent->doc))
+            return(NULL);
+    }
+
     oom = 0;
     for (iter = cur; iter != NULL; iter = iter->next) {
 	if (iter->doc != parent->doc) {
-	    if (xmlSetTreeDoc(iter, parent->doc) < 0)
+	    if (xmlSetTreeDocInternal(iter, parent->doc) < 0)
                 oom = 1;
 	}
     }
     if (oom)
         return(NULL);
 
+    xmlDocIndexInvalidate(parent->doc);
+    xmlNodeSourceChanged(parent);
+
     /*
      * add the first element at the end of the children list.
      */
@@ -3318,6 +3808,77 @@ xmlNextElementSibling(xmlNode *node) {
     return(NULL);
 }
 
+static xmlNodePtr
+xmlNthChildInternal(xmlNodePtr parent, int n, int elements) {
+    xmlNodePtr *nodes;
+    xmlNodePtr cur;
+    int nb;
+
+    if ((parent == NULL) || (n < 0))
+        return(NULL);
+    switch (parent->type) {
+        case XML_ELEMENT_NODE:
+        case XML_DOCUMENT_NODE:
+        case XML_DOCUMENT_FRAG_NODE:
+        case XML_HTML_DOCUMENT_NODE:
+        case XML_ENTITY_DECL:
+            break;
+        default:
+            return(NULL);
+    }
+
+    if ((n >= XML_CHILD_INDEX_MIN) &&
+        (xmlDocIndexChildren(parent, elements, &nodes, &nb, NULL) == 0))
+        return((n < nb) ? nodes[n] : NULL);
+
+    for (cur = parent->children; cur != NULL; cur = cur->next) {
+        if ((elements) && (cur->type != XML_ELEMENT_NODE))
+            continue;
+        if (n == 0)
+            return(cur);
+        n--;
+    }
+    return(NULL);
+}
+
+/**
+ * Find the child node at a position.
+ *
+ * If the name index of the document is enabled (see
+ * #xmlDocSetNameIndex), the children of nodes with many children
+ * are looked up in constant time. Otherwise, the list of children
+ * is walked.
+ *
+ * @since 2.16.0
+ *
+ * @param parent  the parent node
+ * @param n  the zero-based position
+ * @returns the child or NULL if `parent` has no child at this
+ * position.
+ */
+xmlNode *
+xmlNthChild(xmlNode *parent, int n) {
+    return(xmlNthChildInternal(parent, n, 0));
+}
+
+/**
+ * Find the element child at a position. Only element children
+ * are counted. Note that entity references are not expanded.
+ *
+ * See #xmlNthChild for performance considerations.
+ *
+ * @since 2.16.0
+ *
+ * @param parent  the parent node
+ * @param n  the zero-based position
+ * @returns the element or NULL if `parent` has no element child at
+ * this position.
+ */
+xmlNode *
+xmlNthElementChild(xmlNode *parent, int n) {
+    return(xmlNthChildInternal(parent, n, 1));
+}
+
 /**
  * Free a node list including all children.
  *
@@ -3336,6 +3897,8 @@ xmlFreeNodeList(xmlNode *cur) {
 	return;
     }
     if (cur->doc != NULL) dict = cur->doc->dict;
+    xmlDocIndexRemoved(cur);
+    xmlNodeSourceChanged(cur->parent);
     while (1) {
         while ((cur->children != NULL) &&
                (cur->type != XML_DOCUMENT_NODE) &&
@@ -3362,6 +3925,8 @@ xmlFreeNodeList(xmlNode *cur) {
 	    if ((xmlRegisterCallbacks) && (xmlDeregisterNodeDefaultValue))
 		xmlDeregisterNodeDefaultValue(cur);
 
+            if (cur->type == XML_ELEMENT_NODE)
+                xmlNodeSourceForget(cur->doc, cur);
 	    if (((cur->type == XML_ELEMENT_NODE) ||
 		 (cur->type == XML_XINCLUDE_START) ||
 		 (cur->type == XML_XINCLUDE_END)) &&
@@ -3372,7 +3937,7 @@ xmlFreeNodeList(xmlNode *cur) {
 		(cur->type != XML_XINCLUDE_END) &&
 		(cur->type != XML_ENTITY_REF_NODE) &&
 		(cur->content != (xmlChar *) &(cur->properties))) {
-		DICT_FREE(cur->content)
+		CONTENT_FREE(cur->doc, cur->content)
 	    }
 	    if (((cur->type == XML_ELEMENT_NODE) ||
 	         (cur->type == XML_XINCLUDE_START) ||
@@ -3390,7 +3955,7 @@ xmlFreeNodeList(xmlNode *cur) {
 		(cur->type != XML_TEXT_NODE) &&
 		(cur->type != XML_COMMENT_NODE))
 		DICT_FREE(cur->name)
-	    xmlFree(cur);
+	    xmlTreeFree(cur->doc, cur);
 	}
 
         if (next != NULL) {
@@ -3442,6 +4007,14 @@ xmlFreeNode(xmlNode *cur) {
 
     if (cur->doc != NULL) dict = cur->doc->dict;
 
+    if (cur->type == XML_ELEMENT_NODE)
+        xmlDocIndexRemoved(cur);
+    else if (cur->parent != NULL)
+        xmlDocIndexOrderChanged(cur->doc);
+    xmlNodeSourceChanged(cur->parent);
+    if (cur->type == XML_ELEMENT_NODE)
+        xmlNodeSourceForget(cur->doc, cur);
+
     if ((cur->children != NULL) &&
 	(cur->type != XML_ENTITY_REF_NODE))
 	xmlFreeNodeList(cur->children);
@@ -3456,7 +4029,7 @@ xmlFreeNode(xmlNode *cur) {
     } else if ((cur->content != NULL) &&
                (cur->type != XML_ENTITY_REF_NODE) &&
                (cur->content != (xmlChar *) &(cur->properties))) {
-        DICT_FREE(cur->content)
+        CONTENT_FREE(cur->doc, cur->content)
     }
 
     /*
@@ -3469,7 +4042,7 @@ xmlFreeNode(xmlNode *cur) {
         (cur->type != XML_COMMENT_NODE))
 	DICT_FREE(cur->name)
 
-    xmlFree(cur);
+    xmlTreeFree(cur->doc, cur);
 }
 
 /**
@@ -3485,6 +4058,8 @@ xmlUnlinkNodeInternal(xmlNodePtr cur) {
     if (cur->parent != NULL) {
 	xmlNodePtr parent;
 	parent = cur->parent;
+        xmlDocIndexAttrChanged(cur);
+        xmlNodeSourceChanged(parent);
 	if (cur->type == XML_ATTRIBUTE_NODE) {
 	    if (parent->properties == (xmlAttrPtr) cur)
 		parent->properties = ((xmlAttrPtr) cur)->next;
@@ -3494,6 +4069,10 @@ xmlUnlinkNodeInternal(xmlNodePtr cur) {
 	    if (parent->last == cur)
 		parent->last = cur->prev;
 	}
+        if (cur->type == XML_ELEMENT_NODE)
+            xmlDocIndexInvalidate(cur->doc);
+        else
+            xmlDocIndexOrderChanged(cur->doc);
 	cur->parent = NULL;
     }
 
@@ -3572,9 +4151,17 @@ xmlReplaceNode(xmlNode *old, xmlNode *cur) {
     if ((cur->type==XML_ATTRIBUTE_NODE) && (old->type!=XML_ATTRIBUTE_NODE)) {
 	return(old);
     }
+    if (!xmlTreeCanMove(cur, old->doc))
+        return(NULL);
     xmlUnlinkNodeInternal(cur);
-    if (xmlSetTreeDoc(cur, old->doc) < 0)
+    if (xmlSetTreeDocInternal(cur, old->doc) < 0)
         return(NULL);
+    if ((old->type == XML_ELEMENT_NODE) || (cur->type == XML_ELEMENT_NODE))
+        xmlDocIndexInvalidate(old->doc);
+    else
+        xmlDocIndexOrderChanged(old->doc);
+    xmlDocIndexAttrChanged(old);
+    xmlNodeSourceChanged(old->parent);
     cur->parent = old->parent;
     cur->next = old->next;
     if (cur->next != NULL)
@@ -3655,88 +4242,301 @@ xmlCopyNamespaceList(xmlNs *cur) {
     return(ret);
 }
 
-static xmlAttrPtr
-xmlCopyPropInternal(xmlDocPtr doc, xmlNodePtr target, xmlAttrPtr cur) {
-    xmlAttrPtr ret = NULL;
+/*
+ * Namespaces in scope of the ancestors of a node during a deep
+ * copy. The namespaces declared on copied ancestors are kept on a
+ * stack, namespaces found outside of the copied subtree are cached,
+ * so that namespaces can be resolved without walking up the tree.
+ */
+typedef struct {
+    xmlNsPtr ns;                /* NULL for non-element ancestors */
+    xmlNodePtr owner;           /* the copied ancestor */
+} xmlCopyNsEntry;
 
-    if (cur == NULL) return(NULL);
-    if ((target != NULL) && (target->type != XML_ELEMENT_NODE))
-        return(NULL);
-    if (target != NULL)
-	ret = xmlNewDocProp(target->doc, cur->name, NULL);
-    else if (doc != NULL)
-	ret = xmlNewDocProp(doc, cur->name, NULL);
-    else if (cur->parent != NULL)
-	ret = xmlNewDocProp(cur->parent->doc, cur->name, NULL);
-    else if (cur->children != NULL)
-	ret = xmlNewDocProp(cur->children->doc, cur->name, NULL);
-    else
-	ret = xmlNewDocProp(NULL, cur->name, NULL);
-    if (ret == NULL) return(NULL);
-    ret->parent = target;
+#define XML_COPY_NS_MAX_OUTER 16
 
-    if ((cur->ns != NULL) && (target != NULL)) {
-      xmlNsPtr ns;
-      int res;
+typedef struct {
+    xmlCopyNsEntry *tab;
+    int nr;
+    int max;
+    int nbOuter;
+    const xmlChar *outerPrefix[XML_COPY_NS_MAX_OUTER];
+    xmlNsPtr outerNs[XML_COPY_NS_MAX_OUTER];
+} xmlCopyNsScope;
 
-      res = xmlSearchNsSafe(target, cur->ns->prefix, &ns);
-      if (res < 0)
-          goto error;
-      if (ns == NULL) {
-        /*
-         * Humm, we are copying an element whose namespace is defined
-         * out of the new tree scope. Search it in the original tree
-         * and add it at the top of the new tree
-         */
-        res = xmlSearchNsSafe(cur->parent, cur->ns->prefix, &ns);
-        if (res < 0)
-          goto error;
-        if (ns != NULL) {
-          xmlNodePtr root = target;
-          xmlNodePtr pred = NULL;
+/**
+ * Push the namespaces of a copied node before copying its children.
+ * The lookup order of #xmlSearchNsSafe is preserved.
+ *
+ * @param scope  the namespace scope
+ * @param node  the copied node
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+static int
+xmlCopyNsScopePush(xmlCopyNsScope *scope, xmlNodePtr node) {
+    xmlNsPtr ns;
+    int nb = 0, i;
 
-          while (root->parent != NULL) {
-            pred = root;
-            root = root->parent;
-          }
-          if (root == (xmlNodePtr) target->doc) {
-            /* correct possibly cycling above the document elt */
-            root = pred;
-          }
-          ret->ns = xmlNewNs(root, ns->href, ns->prefix);
-          if (ret->ns == NULL)
-              goto error;
-        }
-      } else {
-        /*
-         * we have to find something appropriate here since
-         * we can't be sure, that the namespace we found is identified
-         * by the prefix
-         */
-        if (xmlStrEqual(ns->href, cur->ns->href)) {
-          /* this is the nice case */
-          ret->ns = ns;
-        } else {
-          /*
-           * we are in trouble: we need a new reconciled namespace.
-           * This is expensive
-           */
-          ret->ns = xmlNewReconciledNs(target, cur->ns);
-          if (ret->ns == NULL)
-              goto error;
-        }
-      }
+    if (node->type != XML_ELEMENT_NODE) {
+        nb = 1;
+    } else {
+        for (ns = node->nsDef; ns != NULL; ns = ns->next)
+            nb++;
+        if (node->ns != NULL)
+            nb++;
+        if (nb == 0)
+            return(0);
+    }
 
-    } else
-        ret->ns = NULL;
+    while (scope->nr + nb > scope->max) {
+        xmlCopyNsEntry *tmp;
+        int newSize;
 
-    if (cur->children != NULL) {
-	xmlNodePtr tmp;
+        newSize = xmlGrowCapacity(scope->max, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(scope->tab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        scope->tab = tmp;
+        scope->max = newSize;
+    }
 
-	ret->children = xmlStaticCopyNodeList(cur->children, ret->doc, (xmlNodePtr) ret);
-        if (ret->children == NULL)
-            goto error;
-	ret->last = NULL;
+    if (node->type != XML_ELEMENT_NODE) {
+        /* Searches stop at non-element ancestors */
+        scope->tab[scope->nr].ns = NULL;
+        scope->tab[scope->nr].owner = node;
+        scope->nr++;
+        return(0);
+    }
+
+    /* The top of the stack is searched first */
+    if (node->ns != NULL) {
+        scope->tab[scope->nr].ns = node->ns;
+        scope->tab[scope->nr].owner = node;
+    }
+    i = scope->nr + nb - 1;
+    for (ns = node->nsDef; ns != NULL; ns = ns->next) {
+        scope->tab[i].ns = ns;
+        scope->tab[i].owner = node;
+        i--;
+    }
+    scope->nr += nb;
+
+    return(0);
+}
+
+/**
+ * Pop the namespaces of a copied node after copying its children.
+ *
+ * @param scope  the namespace scope
+ * @param node  the copied node
+ */
+static void
+xmlCopyNsScopePop(xmlCopyNsScope *scope, xmlNodePtr node) {
+    while ((scope->nr > 0) && (scope->tab[scope->nr - 1].owner == node))
+        scope->nr--;
+}
+
+/**
+ * Same as #xmlSearchNsSafe for a copied element or the target of
+ * a copied attribute whose copied ancestors are on the stack.
+ *
+ * Namespaces which aren't declared on copied ancestors are either
+ * declared outside of the copied subtree or added to the root of
+ * the copy. Both are in scope of all copied nodes, so they are
+ * cached by prefix.
+ *
+ * @param scope  the namespace scope (optional)
+ * @param node  the copied element
+ * @param prefix  the namespace prefix
+ * @param out  pointer to resulting namespace
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+xmlCopyNsScopeSearch(xmlCopyNsScope *scope, xmlNodePtr node,
+                     const xmlChar *prefix, xmlNsPtr *out) {
+    xmlNsPtr ns;
+    int res, i;
+
+    if ((scope == NULL) || (IS_STR_XML(prefix)))
+        return(xmlSearchNsSafe(node, prefix, out));
+
+    for (ns = node->nsDef; ns != NULL; ns = ns->next) {
+        if ((xmlStrEqual(ns->prefix, prefix)) && (ns->href != NULL)) {
+            *out = ns;
+            return(0);
+        }
+    }
+    for (i = scope->nr - 1; i >= 0; i--) {
+        ns = scope->tab[i].ns;
+        if (ns == NULL)
+            return(xmlSearchNsSafe(node, prefix, out));
+        if ((xmlStrEqual(ns->prefix, prefix)) && (ns->href != NULL)) {
+            *out = ns;
+            return(0);
+        }
+    }
+    for (i = 0; i < scope->nbOuter; i++) {
+        if (xmlStrEqual(scope->outerPrefix[i], prefix)) {
+            *out = scope->outerNs[i];
+            return(0);
+        }
+    }
+
+    res = xmlSearchNsSafe(node, prefix, out);
+    if ((res == 0) && (*out != NULL) &&
+        (scope->nbOuter < XML_COPY_NS_MAX_OUTER)) {
+        scope->outerPrefix[scope->nbOuter] = prefix;
+        scope->outerNs[scope->nbOuter] = *out;
+        scope->nbOuter++;
+    }
+
+    return(res);
+}
+
+/**
+ * Copy a node name for a document. Names are shared if both
+ * documents use the same dictionary.
+ *
+ * @param doc  the target document (optional)
+ * @param srcDoc  the source document (optional)
+ * @param name  the name
+ * @returns the copy or NULL if a memory allocation failed.
+ */
+static const xmlChar *
+xmlCopyNodeName(xmlDocPtr doc, xmlDocPtr srcDoc, const xmlChar *name) {
+    xmlDictPtr dict;
+
+    if ((doc == NULL) || (doc->dict == NULL))
+        return(xmlStrdup(name));
+    dict = doc->dict;
+    if ((srcDoc != NULL) && (srcDoc->dict == dict) &&
+        (xmlDictOwns(dict, name)))
+        return(name);
+    return(xmlDictLookup(dict, name, -1));
+}
+
+/**
+ * Copy the content of a text node for a document. Content is
+ * shared if it's owned by a dictionary used by both documents and
+ * allocated from the arena of the target document otherwise.
+ *
+ * @param doc  the target document (optional)
+ * @param srcDoc  the source document (optional)
+ * @param content  the content
+ * @returns the copy or NULL if a memory allocation failed.
+ */
+static xmlChar *
+xmlCopyTextContent(xmlDocPtr doc, xmlDocPtr srcDoc,
+                   const xmlChar *content) {
+    if ((doc != NULL) && (doc->dict != NULL) &&
+        (srcDoc != NULL) && (srcDoc->dict == doc->dict) &&
+        (xmlDictOwns(doc->dict, content)))
+        return((xmlChar *) content);
+    return(xmlTreeStrndup(doc, content, xmlStrlen(content)));
+}
+
+static xmlNodePtr
+xmlCopyNodeInternal(xmlCopyNsScope *scope, xmlNodePtr node, xmlDocPtr doc,
+                    xmlNodePtr parent, int extended);
+
+static xmlAttrPtr
+xmlCopyPropInternal(xmlCopyNsScope *scope, xmlDocPtr doc, xmlNodePtr target,
+                    xmlAttrPtr cur) {
+    xmlAttrPtr ret = NULL;
+
+    if (cur == NULL) return(NULL);
+    if ((target != NULL) && (target->type != XML_ELEMENT_NODE))
+        return(NULL);
+    if (target != NULL)
+        doc = target->doc;
+    else if ((doc == NULL) && (cur->parent != NULL))
+        doc = cur->parent->doc;
+    else if ((doc == NULL) && (cur->children != NULL))
+        doc = cur->children->doc;
+
+    /*
+     * Allocate a new property and fill the fields.
+     */
+    ret = (xmlAttrPtr) xmlTreeAlloc(doc, sizeof(xmlAttr));
+    if (ret == NULL)
+        return(NULL);
+    memset(ret, 0, sizeof(xmlAttr));
+    ret->type = XML_ATTRIBUTE_NODE;
+    ret->name = xmlCopyNodeName(doc, cur->doc, cur->name);
+    if (ret->name == NULL) {
+        xmlTreeFree(doc, ret);
+        return(NULL);
+    }
+    ret->doc = doc;
+    if ((xmlRegisterCallbacks) && (xmlRegisterNodeDefaultValue))
+	xmlRegisterNodeDefaultValue((xmlNodePtr)ret);
+    ret->parent = target;
+
+    if ((cur->ns != NULL) && (target != NULL)) {
+      xmlNsPtr ns;
+      int res;
+
+      res = xmlCopyNsScopeSearch(scope, target, cur->ns->prefix, &ns);
+      if (res < 0)
+          goto error;
+      if (ns == NULL) {
+        /*
+         * Humm, we are copying an element whose namespace is defined
+         * out of the new tree scope. Search it in the original tree
+         * and add it at the top of the new tree
+         */
+        res = xmlSearchNsSafe(cur->parent, cur->ns->prefix, &ns);
+        if (res < 0)
+          goto error;
+        if (ns != NULL) {
+          xmlNodePtr root = target;
+          xmlNodePtr pred = NULL;
+
+          while (root->parent != NULL) {
+            pred = root;
+            root = root->parent;
+          }
+          if (root == (xmlNodePtr) target->doc) {
+            /* correct possibly cycling above the document elt */
+            root = pred;
+          }
+          ret->ns = xmlNewNs(root, ns->href, ns->prefix);
+          if (ret->ns == NULL)
+              goto error;
+        }
+      } else {
+        /*
+         * we have to find something appropriate here since
+         * we can't be sure, that the namespace we found is identified
+         * by the prefix
+         */
+        if (xmlStrEqual(ns->href, cur->ns->href)) {
+          /* this is the nice case */
+          ret->ns = ns;
+        } else {
+          /*
+           * we are in trouble: we need a new reconciled namespace.
+           * This is expensive
+           */
+          ret->ns = xmlNewReconciledNs(target, cur->ns);
+          if (ret->ns == NULL)
+              goto error;
+        }
+      }
+
+    } else
+        ret->ns = NULL;
+
+    if (cur->children != NULL) {
+	xmlNodePtr tmp;
+
+	ret->children = xmlStaticCopyNodeList(cur->children, ret->doc, (xmlNodePtr) ret);
+        if (ret->children == NULL)
+            goto error;
+	ret->last = NULL;
 	tmp = ret->children;
 	while (tmp != NULL) {
 	    /* tmp->parent = (xmlNodePtr)ret; */
@@ -3789,28 +4589,17 @@ error:
  */
 xmlAttr *
 xmlCopyProp(xmlNode *target, xmlAttr *cur) {
-	return xmlCopyPropInternal(NULL, target, cur);
+	return xmlCopyPropInternal(NULL, NULL, target, cur);
 }
 
-/**
- * Create a copy of an attribute list. This function sets the
- * parent pointers of the copied attributes to `target` but doesn't
- * set the attributes on the target element.
- *
- * @param target  the element where the attributes will be grafted
- * @param cur  the first attribute
- * @returns the head of the copied list or NULL if a memory
- * allocation failed.
- */
-xmlAttr *
-xmlCopyPropList(xmlNode *target, xmlAttr *cur) {
+static xmlAttrPtr
+xmlCopyPropListInternal(xmlCopyNsScope *scope, xmlNodePtr target,
+                        xmlAttrPtr cur) {
     xmlAttrPtr ret = NULL;
     xmlAttrPtr p = NULL,q;
 
-    if ((target != NULL) && (target->type != XML_ELEMENT_NODE))
-        return(NULL);
     while (cur != NULL) {
-        q = xmlCopyProp(target, cur);
+        q = xmlCopyPropInternal(scope, NULL, target, cur);
 	if (q == NULL) {
             xmlFreePropList(ret);
 	    return(NULL);
@@ -3827,6 +4616,23 @@ xmlCopyPropList(xmlNode *target, xmlAttr *cur) {
     return(ret);
 }
 
+/**
+ * Create a copy of an attribute list. This function sets the
+ * parent pointers of the copied attributes to `target` but doesn't
+ * set the attributes on the target element.
+ *
+ * @param target  the element where the attributes will be grafted
+ * @param cur  the first attribute
+ * @returns the head of the copied list or NULL if a memory
+ * allocation failed.
+ */
+xmlAttr *
+xmlCopyPropList(xmlNode *target, xmlAttr *cur) {
+    if ((target != NULL) && (target->type != XML_ELEMENT_NODE))
+        return(NULL);
+    return(xmlCopyPropListInternal(NULL, target, cur));
+}
+
 /*
  * NOTE about the CopyNode operations !
  *
@@ -3847,17 +4653,18 @@ xmlCopyPropList(xmlNode *target, xmlAttr *cur) {
  */
 
 /**
- * Copy a node.
+ * Copy a node. Deep copies resolve namespaces through `scope`.
  *
+ * @param scope  namespaces in scope of `parent` (optional)
  * @param node  source node
  * @param doc  target document
  * @param parent  target parent
  * @param extended  flags
  * @returns the copy or NULL if a memory allocation failed.
  */
-xmlNode *
-xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
-                  int extended) {
+static xmlNodePtr
+xmlCopyNodeInternal(xmlCopyNsScope *scope, xmlNodePtr node, xmlDocPtr doc,
+                    xmlNodePtr parent, int extended) {
     xmlNodePtr ret;
 
     if (node == NULL) return(NULL);
@@ -3873,7 +4680,8 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
         case XML_XINCLUDE_END:
 	    break;
         case XML_ATTRIBUTE_NODE:
-		return((xmlNodePtr) xmlCopyPropInternal(doc, parent, (xmlAttrPtr) node));
+		return((xmlNodePtr) xmlCopyPropInternal(scope, doc, parent,
+                                                        (xmlAttrPtr) node));
         case XML_NAMESPACE_DECL:
 	    return((xmlNodePtr) xmlCopyNamespaceList((xmlNsPtr) node));
 
@@ -3887,7 +4695,7 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
     /*
      * Allocate a new node and fill the fields.
      */
-    ret = (xmlNodePtr) xmlMalloc(sizeof(xmlNode));
+    ret = (xmlNodePtr) xmlTreeAlloc(doc, sizeof(xmlNode));
     if (ret == NULL)
 	return(NULL);
     memset(ret, 0, sizeof(xmlNode));
@@ -3902,10 +4710,7 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
     else if (node->name == xmlStringComment)
 	ret->name = xmlStringComment;
     else if (node->name != NULL) {
-        if ((doc != NULL) && (doc->dict != NULL))
-	    ret->name = xmlDictLookup(doc->dict, node->name, -1);
-	else
-	    ret->name = xmlStrdup(node->name);
+        ret->name = xmlCopyNodeName(doc, node->doc, node->name);
         if (ret->name == NULL)
             goto error;
     }
@@ -3914,7 +4719,12 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
 	(node->type != XML_ENTITY_REF_NODE) &&
 	(node->type != XML_XINCLUDE_END) &&
 	(node->type != XML_XINCLUDE_START)) {
-	ret->content = xmlStrdup(node->content);
+        if ((node->type == XML_TEXT_NODE) ||
+            (node->type == XML_CDATA_SECTION_NODE))
+            ret->content = xmlCopyTextContent(doc, node->doc,
+                                              node->content);
+        else
+	    ret->content = xmlStrdup(node->content);
         if (ret->content == NULL)
             goto error;
     }else{
@@ -3935,7 +4745,7 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
         xmlNsPtr ns = NULL;
         int res;
 
-	res = xmlSearchNsSafe(ret, node->ns->prefix, &ns);
+	res = xmlCopyNsScopeSearch(scope, ret, node->ns->prefix, &ns);
         if (res < 0)
             goto error;
 	if (ns == NULL) {
@@ -3968,7 +4778,8 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
 	}
     }
     if ((node->type == XML_ELEMENT_NODE) && (node->properties != NULL)) {
-        ret->properties = xmlCopyPropList(ret, node->properties);
+        ret->properties = xmlCopyPropListInternal(scope, ret,
+                                                  node->properties);
         if (ret->properties == NULL)
             goto error;
     }
@@ -3986,14 +4797,22 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
 	}
 	ret->last = ret->children;
     } else if ((node->children != NULL) && (extended != 2)) {
+        xmlCopyNsScope childScope;
         xmlNodePtr cur, insert;
 
+        memset(&childScope, 0, sizeof(childScope));
+        if (xmlCopyNsScopePush(&childScope, ret) < 0)
+            goto error;
+
         cur = node->children;
         insert = ret;
         while (cur != NULL) {
-            xmlNodePtr copy = xmlStaticCopyNode(cur, doc, insert, 2);
-            if (copy == NULL)
+            xmlNodePtr copy = xmlCopyNodeInternal(&childScope, cur, doc,
+                                                  insert, 2);
+            if (copy == NULL) {
+                xmlFree(childScope.tab);
                 goto error;
+            }
 
             /* Check for coalesced text nodes */
             if (insert->last != copy) {
@@ -4008,6 +4827,10 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
 
             if ((cur->type != XML_ENTITY_REF_NODE) &&
                 (cur->children != NULL)) {
+                if (xmlCopyNsScopePush(&childScope, copy) < 0) {
+                    xmlFree(childScope.tab);
+                    goto error;
+                }
                 cur = cur->children;
                 insert = copy;
                 continue;
@@ -4020,6 +4843,7 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
                 }
 
                 cur = cur->parent;
+                xmlCopyNsScopePop(&childScope, insert);
                 insert = insert->parent;
                 if (cur == node) {
                     cur = NULL;
@@ -4027,6 +4851,8 @@ xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
                 }
             }
         }
+
+        xmlFree(childScope.tab);
     }
 
 out:
@@ -4039,6 +4865,21 @@ error:
     return(NULL);
 }
 
+/**
+ * Copy a node.
+ *
+ * @param node  source node
+ * @param doc  target document
+ * @param parent  target parent
+ * @param extended  flags
+ * @returns the copy or NULL if a memory allocation failed.
+ */
+xmlNode *
+xmlStaticCopyNode(xmlNode *node, xmlDoc *doc, xmlNode *parent,
+                  int extended) {
+    return(xmlCopyNodeInternal(NULL, node, doc, parent, extended));
+}
+
 /**
  * Copy a node list. If `parent` is provided, sets the parent pointer
  * of the copied nodes, but doesn't update the children and last
@@ -4307,6 +5148,8 @@ error:
  * Copy a document. If recursive, the content tree will
  * be copied too as well as DTD, namespaces and entities.
  *
+ * Recursive copies share the dictionary of the original document.
+ *
  * @param doc  the document
  * @param recursive  if not zero do a recursive copy.
  * @returns the copied document or NULL if a memory allocation
@@ -4340,6 +5183,21 @@ xmlCopyDoc(xmlDoc *doc, int recursive) {
     ret->standalone = doc->standalone;
     if (!recursive) return(ret);
 
+    /*
+     * Share the dictionary, so that names and interned text don't
+     * have to be copied, and allocate the copy from an arena if the
+     * original was.
+     */
+    if (doc->dict != NULL) {
+        ret->dict = doc->dict;
+        xmlDictReference(ret->dict);
+    }
+    if (doc->arena != NULL) {
+        ret->arena = xmlArenaCreate();
+        if (ret->arena == NULL)
+            goto error;
+    }
+
     ret->last = NULL;
     ret->children = NULL;
     if (doc->intSubset != NULL) {
@@ -4378,4172 +5236,7567 @@ error:
 
 /************************************************************************
  *									*
- *		Content access functions				*
+ *		Document snapshots					*
  *									*
  ************************************************************************/
 
+/*
+ * A snapshot keeps a private copy of a document. Its nodes and text
+ * are also laid out in a single block of memory, the image. Copies
+ * of the snapshot duplicate the image in one allocation from the
+ * arena of the new document and relocate the pointers between nodes.
+ *
+ * In the image, nodes have no document. Parents of top-level nodes
+ * are NULL. Namespace pointers hold indices into nsTab, starting
+ * from 1. Children of entity references point to the entity of the
+ * frozen copy and are looked up again in new documents.
+ */
+struct _xmlDocSnapshot {
+    xmlDocPtr doc;              /* the frozen copy */
+    char *image;
+    size_t nodesSize;           /* size of the nodes in the image */
+    size_t size;                /* total size of the image */
+    xmlNodePtr children;        /* first top-level node in the image */
+    xmlNodePtr last;            /* last top-level node in the image */
+    xmlNodePtr dtdPrev;         /* top-level node before the DTD */
+    xmlNsPtr nsTab;             /* namespaces, links are indices */
+    int nbNs;
+    int nbOldNs;                /* namespaces of doc->oldNs */
+    xmlAttrPtr *idAttrs;        /* ID attributes in the image */
+    xmlChar **idValues;
+    int nbIds;
+};
+
+#define XML_SNAPSHOT_ALIGN(size) \
+    (((size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* Sizes of records in the image */
+#define XML_SNAPSHOT_NODE_SIZE XML_SNAPSHOT_ALIGN(sizeof(xmlNode))
+#define XML_SNAPSHOT_ATTR_SIZE XML_SNAPSHOT_ALIGN(sizeof(xmlAttr))
+
+static xmlNsPtr
+xmlSnapshotNsIndex(xmlNsPtr ns, int *error) {
+    if (ns == NULL)
+        return(NULL);
+    if (ns->_private == NULL)
+        *error = 1;
+    return(ns->_private);
+}
+
+static xmlNodePtr
+xmlSnapshotNodeAddr(xmlNodePtr node) {
+    /* The DTD isn't part of the image */
+    if ((node != NULL) && (node->type == XML_DTD_NODE))
+        node = node->next;
+    /* Top-level nodes have no parent in the image */
+    if ((node == NULL) || (node->type == XML_DOCUMENT_NODE) ||
+        (node->type == XML_HTML_DOCUMENT_NODE))
+        return(NULL);
+    return(node->_private);
+}
+
 /**
- * Get line number of `node`. Try to work around the limitation of
- * line numbers being stored as 16 bits ints. Requires xmlParserOption
- * XML_PARSE_BIG_LINES to be set when parsing.
+ * Copy a namespace of the frozen copy to the namespace table.
  *
- * @param node  valid node
- * @param depth  used to limit any risk of recursion
- * @returns the line number if successful, -1 otherwise
+ * @param snap  the snapshot
+ * @param ns  the namespace
  */
-static long
-xmlGetLineNoInternal(const xmlNode *node, int depth)
-{
-    long result = -1;
+static void
+xmlSnapshotAddNs(xmlDocSnapshotPtr snap, xmlNsPtr ns) {
+    xmlNsPtr copy = &snap->nsTab[XML_PTR_TO_INT(ns->_private) - 1];
+    int error = 0;
 
-    if (depth >= 5)
-        return(-1);
+    *copy = *ns;
+    copy->next = xmlSnapshotNsIndex(ns->next, &error);
+    copy->_private = NULL;
+    copy->context = NULL;
+}
 
-    if (!node)
-        return result;
-    if ((node->type == XML_ELEMENT_NODE) ||
-        (node->type == XML_TEXT_NODE) ||
-	(node->type == XML_COMMENT_NODE) ||
-	(node->type == XML_PI_NODE)) {
-	if (node->line == 65535) {
-	    if ((node->type == XML_TEXT_NODE) && (node->psvi != NULL))
-	        result = XML_PTR_TO_INT(node->psvi);
-	    else if ((node->type == XML_ELEMENT_NODE) &&
-	             (node->children != NULL))
-	        result = xmlGetLineNoInternal(node->children, depth + 1);
-	    else if (node->next != NULL)
-	        result = xmlGetLineNoInternal(node->next, depth + 1);
-	    else if (node->prev != NULL)
-	        result = xmlGetLineNoInternal(node->prev, depth + 1);
-	}
-	if ((result == -1) || (result == 65535))
-	    result = node->line;
-    } else if ((node->prev != NULL) &&
-             ((node->prev->type == XML_ELEMENT_NODE) ||
-	      (node->prev->type == XML_TEXT_NODE) ||
-	      (node->prev->type == XML_COMMENT_NODE) ||
-	      (node->prev->type == XML_PI_NODE)))
-        result = xmlGetLineNoInternal(node->prev, depth + 1);
-    else if ((node->parent != NULL) &&
-             (node->parent->type == XML_ELEMENT_NODE))
-        result = xmlGetLineNoInternal(node->parent, depth + 1);
+/**
+ * Handle a node of the frozen copy. The first pass computes sizes
+ * and indexes namespaces, the second pass assigns addresses in the
+ * image, the third pass fills the image and the last pass resets
+ * the frozen copy.
+ *
+ * @param snap  the snapshot
+ * @param node  the node (element, attribute or other content)
+ * @param pass  the pass
+ * @param offsets  current offsets of nodes and strings
+ * @returns 0 on success, -1 on error.
+ */
+static int
+xmlSnapshotVisit(xmlDocSnapshotPtr snap, xmlNodePtr node, int pass,
+                 size_t *offsets) {
+    xmlDictPtr dict = snap->doc->dict;
+    size_t size;
+    int hasContent = 0;
+    int error = 0;
 
-    return result;
+    switch (node->type) {
+        case XML_ELEMENT_NODE:
+        case XML_XINCLUDE_START:
+        case XML_XINCLUDE_END:
+        case XML_ENTITY_REF_NODE:
+            break;
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_PI_NODE:
+        case XML_COMMENT_NODE:
+            hasContent = (node->content != NULL) &&
+                         (!xmlDictOwns(dict, node->content));
+            break;
+        case XML_ATTRIBUTE_NODE:
+            break;
+        default:
+            return(-1);
+    }
+    size = (node->type == XML_ATTRIBUTE_NODE) ?
+           XML_SNAPSHOT_ATTR_SIZE : XML_SNAPSHOT_NODE_SIZE;
+
+    if (pass == 0) {
+        xmlNsPtr ns;
+
+        if (offsets[0] > SIZE_MAX / 2)
+            return(-1);
+        offsets[0] += size;
+        if (hasContent) {
+            size_t len = strlen((const char *) node->content);
+
+            if (offsets[1] > SIZE_MAX / 2 - len)
+                return(-1);
+            offsets[1] += len + 1;
+        }
+        if ((node->type == XML_ELEMENT_NODE) ||
+            (node->type == XML_XINCLUDE_START)) {
+            for (ns = node->nsDef; ns != NULL; ns = ns->next) {
+                if (snap->nbNs >= XML_MAX_ITEMS)
+                    return(-1);
+                snap->nbNs++;
+                ns->_private = XML_INT_TO_PTR(snap->nbNs);
+            }
+        }
+        if ((node->type == XML_ATTRIBUTE_NODE) &&
+            (((xmlAttrPtr) node)->id != NULL)) {
+            if (snap->nbIds >= XML_MAX_ITEMS)
+                return(-1);
+            snap->nbIds++;
+        }
+    } else if (pass == 1) {
+        node->_private = snap->image + offsets[0];
+        offsets[0] += size;
+    } else if (pass == 3) {
+        xmlNsPtr ns;
+
+        node->_private = NULL;
+        if ((node->type == XML_ELEMENT_NODE) ||
+            (node->type == XML_XINCLUDE_START)) {
+            for (ns = node->nsDef; ns != NULL; ns = ns->next)
+                ns->_private = NULL;
+        }
+    } else {
+        xmlNodePtr copy = node->_private;
+
+        memcpy(copy, node, size);
+        copy->_private = NULL;
+        copy->doc = NULL;
+        if (node->type != XML_ENTITY_REF_NODE) {
+            copy->children = xmlSnapshotNodeAddr(node->children);
+            copy->last = xmlSnapshotNodeAddr(node->last);
+        }
+        copy->parent = xmlSnapshotNodeAddr(node->parent);
+        copy->next = xmlSnapshotNodeAddr(node->next);
+        if ((node->prev != NULL) && (node->prev->type == XML_DTD_NODE))
+            copy->prev = xmlSnapshotNodeAddr(node->prev->prev);
+        else
+            copy->prev = xmlSnapshotNodeAddr(node->prev);
+        copy->ns = xmlSnapshotNsIndex(node->ns, &error);
+
+        if ((node->name != NULL) &&
+            (node->name != xmlStringText) &&
+            (node->name != xmlStringTextNoenc) &&
+            (node->name != xmlStringComment) &&
+            (!xmlDictOwns(dict, node->name))) {
+            copy->name = xmlDictLookup(dict, node->name, -1);
+            if (copy->name == NULL)
+                return(-1);
+        }
+
+        if (node->type == XML_ATTRIBUTE_NODE) {
+            xmlAttrPtr attr = (xmlAttrPtr) node;
+            xmlAttrPtr attrCopy = (xmlAttrPtr) copy;
+
+            attrCopy->atype = 0;
+            attrCopy->id = NULL;
+            if (attr->id != NULL) {
+                snap->idValues[snap->nbIds] = xmlStrdup(attr->id->value);
+                if (snap->idValues[snap->nbIds] == NULL)
+                    return(-1);
+                snap->idAttrs[snap->nbIds] = attrCopy;
+                snap->nbIds++;
+            }
+        } else if ((node->type == XML_ELEMENT_NODE) ||
+                   (node->type == XML_XINCLUDE_START) ||
+                   (node->type == XML_XINCLUDE_END)) {
+            xmlNsPtr ns;
+
+            copy->properties = (xmlAttrPtr)
+                xmlSnapshotNodeAddr((xmlNodePtr) node->properties);
+            copy->nsDef = xmlSnapshotNsIndex(node->nsDef, &error);
+            for (ns = node->nsDef; ns != NULL; ns = ns->next)
+                xmlSnapshotAddNs(snap, ns);
+        } else {
+            copy->properties = NULL;
+            copy->nsDef = NULL;
+            if (hasContent) {
+                size_t len = strlen((const char *) node->content);
+
+                copy->content = (xmlChar *) snap->image + offsets[1];
+                memcpy(copy->content, node->content, len + 1);
+                offsets[1] += len + 1;
+            }
+        }
+    }
+
+    return(error ? -1 : 0);
 }
 
 /**
- * Get line number of `node`. Try to work around the limitation of
- * line numbers being stored as 16 bits ints. Requires xmlParserOption
- * XML_PARSE_BIG_LINES to be set when parsing.
+ * Run a pass over the nodes of the frozen copy in document order.
  *
- * @param node  valid node
- * @returns the line number if successful, -1 otherwise
+ * @param snap  the snapshot
+ * @param pass  the pass
+ * @param offsets  current offsets of nodes and strings
+ * @returns 0 on success, -1 on error.
  */
-long
-xmlGetLineNo(const xmlNode *node)
-{
-    return(xmlGetLineNoInternal(node, 0));
+static int
+xmlSnapshotPass(xmlDocSnapshotPtr snap, int pass, size_t *offsets) {
+    xmlDocPtr doc = snap->doc;
+    xmlNodePtr cur = doc->children;
+
+    while (cur != NULL) {
+        if (cur->type == XML_DTD_NODE) {
+            if (cur != (xmlNodePtr) doc->intSubset)
+                return(-1);
+            if (pass == 2)
+                snap->dtdPrev = xmlSnapshotNodeAddr(cur->prev);
+            cur = cur->next;
+            continue;
+        }
+
+        if (xmlSnapshotVisit(snap, cur, pass, offsets) < 0)
+            return(-1);
+        if (cur->type == XML_ELEMENT_NODE) {
+            xmlAttrPtr attr;
+            xmlNodePtr child;
+
+            for (attr = cur->properties; attr != NULL; attr = attr->next) {
+                if (xmlSnapshotVisit(snap, (xmlNodePtr) attr, pass,
+                                     offsets) < 0)
+                    return(-1);
+                for (child = attr->children; child != NULL;
+                     child = child->next) {
+                    if (((child->type != XML_TEXT_NODE) &&
+                         (child->type != XML_ENTITY_REF_NODE)) ||
+                        (xmlSnapshotVisit(snap, child, pass, offsets) < 0))
+                        return(-1);
+                }
+            }
+        }
+
+        if ((cur->type != XML_ENTITY_REF_NODE) && (cur->children != NULL)) {
+            cur = cur->children;
+            continue;
+        }
+
+        while (cur->next == NULL) {
+            cur = cur->parent;
+            if (cur == (xmlNodePtr) doc)
+                return(0);
+        }
+        cur = cur->next;
+    }
+
+    return(0);
 }
 
 /**
- * Build a structure based Path for the given node
+ * Create a snapshot of a document. Copies of the snapshot are made
+ * with #xmlDocSnapshotCopy which is much faster than #xmlCopyDoc
+ * for large documents: all nodes and text of a copy are duplicated
+ * with a single allocation and names are shared through the
+ * dictionary.
  *
- * @param node  a node
- * @returns the new path or NULL in case of error. The caller must free
- *     the returned string
+ * The snapshot is independent of the original document which can
+ * be modified or freed afterwards. Copies of a snapshot can be made
+ * from multiple threads concurrently.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  the document
+ * @returns the snapshot or NULL if the document contains unsupported
+ * nodes or a memory allocation failed.
  */
-xmlChar *
-xmlGetNodePath(const xmlNode *node)
-{
-    const xmlNode *cur, *tmp;
-    const xmlNode **nodes = NULL;
-    xmlChar *ret = NULL;
-    xmlBuf *buf;
-    size_t numNodes, i;
+xmlDocSnapshot *
+xmlNewDocSnapshot(xmlDoc *doc) {
+    xmlDocSnapshotPtr snap;
+    xmlDocPtr copy;
+    xmlNsPtr ns;
+    size_t offsets[2] = { 0, 0 };
+    int nbIds;
 
-    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
+    if (doc == NULL)
         return(NULL);
 
-    buf = xmlBufCreate(50);
-    if (buf == NULL)
+    snap = xmlMalloc(sizeof(*snap));
+    if (snap == NULL)
         return(NULL);
+    memset(snap, 0, sizeof(*snap));
 
-    /*
-     * Get list of ancestors
-     */
-    numNodes = 0;
-    for (cur = node; cur != NULL; cur = cur->parent)
-        numNodes += 1;
-    if (numNodes > SIZE_MAX / sizeof(nodes[0]))
+    copy = xmlCopyDoc(doc, 1);
+    if (copy == NULL)
         goto error;
-    nodes = xmlMalloc(numNodes * sizeof(nodes[0]));
-    if (nodes == NULL)
+    snap->doc = copy;
+    if (copy->dict == NULL) {
+        copy->dict = xmlDictCreate();
+        if (copy->dict == NULL)
+            goto error;
+    }
+
+    for (ns = copy->oldNs; ns != NULL; ns = ns->next) {
+        snap->nbNs++;
+        ns->_private = XML_INT_TO_PTR(snap->nbNs);
+    }
+    snap->nbOldNs = snap->nbNs;
+
+    if (xmlSnapshotPass(snap, 0, offsets) < 0)
+        goto error;
+    /* Counts the ID values from now on */
+    nbIds = snap->nbIds;
+    snap->nbIds = 0;
+    snap->nodesSize = offsets[0];
+    snap->size = offsets[0] + offsets[1];
+    snap->image = xmlMalloc(snap->size + 1);
+    snap->nsTab = xmlMalloc((snap->nbNs + 1) * sizeof(xmlNs));
+    snap->idAttrs = xmlMalloc((nbIds + 1) * sizeof(xmlAttrPtr));
+    snap->idValues = xmlMalloc((nbIds + 1) * sizeof(xmlChar *));
+    if ((snap->image == NULL) || (snap->nsTab == NULL) ||
+        (snap->idAttrs == NULL) || (snap->idValues == NULL))
         goto error;
-    i = 0;
-    for (cur = node; cur != NULL && i < numNodes; cur = cur->parent)
-        nodes[i++] = cur;
 
-    /*
-     * Iterate in reverse to start at root
-     */
-    while (i > 0) {
-        int occur = 0;
+    offsets[0] = 0;
+    if (xmlSnapshotPass(snap, 1, offsets) < 0)
+        goto error;
+    offsets[0] = 0;
+    offsets[1] = snap->nodesSize;
+    if (xmlSnapshotPass(snap, 2, offsets) < 0)
+        goto error;
+    snap->children = xmlSnapshotNodeAddr(copy->children);
+    if ((copy->last != NULL) && (copy->last->type == XML_DTD_NODE))
+        snap->last = xmlSnapshotNodeAddr(copy->last->prev);
+    else
+        snap->last = xmlSnapshotNodeAddr(copy->last);
 
-        i -= 1;
-        cur = nodes[i];
+    for (ns = copy->oldNs; ns != NULL; ns = ns->next)
+        xmlSnapshotAddNs(snap, ns);
 
-        if ((cur->type == XML_DOCUMENT_NODE) ||
-            (cur->type == XML_HTML_DOCUMENT_NODE)) {
-            if (i == 0)
-                xmlBufCat(buf, BAD_CAST "/");
-        } else if (cur->type == XML_ELEMENT_NODE) {
-            int generic = 0;
+    /* Reset the frozen copy */
+    xmlSnapshotPass(snap, 3, offsets);
+    for (ns = copy->oldNs; ns != NULL; ns = ns->next)
+        ns->_private = NULL;
 
-            xmlBufCat(buf, BAD_CAST "/");
+    return(snap);
 
-            if (cur->ns) {
-		if (cur->ns->prefix != NULL) {
-                    xmlBufCat(buf, cur->ns->prefix);
-                    xmlBufCat(buf, BAD_CAST ":");
-                    xmlBufCat(buf, cur->name);
-		} else {
-		    /*
-		    * We cannot express named elements in the default
-		    * namespace, so use "*".
-		    */
-		    generic = 1;
-                    xmlBufCat(buf, BAD_CAST "*");
-		}
-            } else {
-                xmlBufCat(buf, cur->name);
-            }
+error:
+    if (snap->doc != NULL) {
+        xmlSnapshotPass(snap, 3, offsets);
+        for (ns = copy->oldNs; ns != NULL; ns = ns->next)
+            ns->_private = NULL;
+    }
+    xmlFreeDocSnapshot(snap);
+    return(NULL);
+}
 
-            /*
-             * Thumbler index computation
-	     * TODO: the occurrence test seems bogus for namespaced names
-             */
-            tmp = cur->prev;
-            while (tmp != NULL) {
-                if ((tmp->type == XML_ELEMENT_NODE) &&
-		    (generic ||
-		     (xmlStrEqual(cur->name, tmp->name) &&
-		     ((tmp->ns == cur->ns) ||
-		      ((tmp->ns != NULL) && (cur->ns != NULL) &&
-		       (xmlStrEqual(cur->ns->prefix, tmp->ns->prefix)))))))
-                    occur++;
-                tmp = tmp->prev;
+static void *
+xmlSnapshotReloc(void *ptr, XML_INTPTR_T delta) {
+    if (ptr == NULL)
+        return(NULL);
+    return((char *) ptr + delta);
+}
+
+/**
+ * Make a copy of a document from a snapshot. The result is the same
+ * as calling #xmlCopyDoc on the original document at the time the
+ * snapshot was made.
+ *
+ * The copy shares the dictionary of the snapshot and its nodes are
+ * allocated from an arena. Like with documents parsed with
+ * XML_PARSE_ARENA, the memory of nodes is only released when the
+ * whole document is freed and nodes must not be moved to other
+ * documents.
+ *
+ * @since 2.16.0
+ *
+ * @param snap  the snapshot
+ * @returns the copied document or NULL if a memory allocation
+ * failed.
+ */
+xmlDoc *
+xmlDocSnapshotCopy(xmlDocSnapshot *snap) {
+    xmlDocPtr ret;
+    xmlNsPtr *nsTab = NULL;
+    char *base;
+    XML_INTPTR_T delta, start, end;
+    size_t offset;
+    int i;
+
+    if (snap == NULL)
+        return(NULL);
+
+    ret = xmlCopyDoc(snap->doc, 0);
+    if (ret == NULL)
+        return(NULL);
+    ret->dict = snap->doc->dict;
+    xmlDictReference(ret->dict);
+    if (snap->doc->intSubset != NULL) {
+        ret->intSubset = xmlCopyDtd(snap->doc->intSubset);
+        if (ret->intSubset == NULL)
+            goto error;
+        /* Can't fail on DTD */
+        xmlSetTreeDoc((xmlNodePtr) ret->intSubset, ret);
+    }
+
+    ret->arena = xmlArenaCreate();
+    if (ret->arena == NULL)
+        goto error;
+    base = xmlArenaAlloc(ret->arena, snap->size + 1);
+    if (base == NULL)
+        goto error;
+    memcpy(base, snap->image, snap->size);
+
+    /*
+     * Namespaces are freed individually, so they can't be part of
+     * the image.
+     */
+    if (snap->nbNs > 0) {
+        nsTab = xmlMalloc(snap->nbNs * sizeof(nsTab[0]));
+        if (nsTab == NULL)
+            goto error;
+        for (i = 0; i < snap->nbNs; i++) {
+            xmlNsPtr ns = xmlCopyNamespace(&snap->nsTab[i]);
+
+            if (ns == NULL) {
+                while (--i >= 0)
+                    xmlFreeNs(nsTab[i]);
+                xmlFree(nsTab);
+                goto error;
             }
-            if (occur == 0) {
-                tmp = cur->next;
-                while (tmp != NULL && occur == 0) {
-                    if ((tmp->type == XML_ELEMENT_NODE) &&
-			(generic ||
-			 (xmlStrEqual(cur->name, tmp->name) &&
-			 ((tmp->ns == cur->ns) ||
-			  ((tmp->ns != NULL) && (cur->ns != NULL) &&
-			   (xmlStrEqual(cur->ns->prefix, tmp->ns->prefix)))))))
-                        occur++;
-                    tmp = tmp->next;
-                }
-                if (occur != 0)
-                    occur = 1;
-            } else
-                occur++;
-        } else if (cur->type == XML_COMMENT_NODE) {
-            xmlBufCat(buf, BAD_CAST "/comment()");
+            nsTab[i] = ns;
+        }
+        for (i = 0; i < snap->nbNs; i++) {
+            if (snap->nsTab[i].next != NULL)
+                nsTab[i]->next =
+                    nsTab[XML_PTR_TO_INT(snap->nsTab[i].next) - 1];
+        }
+        if (snap->nbOldNs > 0)
+            ret->oldNs = nsTab[0];
+    }
 
-            /*
-             * Thumbler index computation
-             */
-            tmp = cur->prev;
-            while (tmp != NULL) {
-                if (tmp->type == XML_COMMENT_NODE)
-		    occur++;
-                tmp = tmp->prev;
+    /*
+     * Relocate the nodes in a linear scan of the image
+     */
+    delta = XML_PTR_TO_INT(base) - XML_PTR_TO_INT(snap->image);
+    start = XML_PTR_TO_INT(snap->image);
+    end = start + snap->size;
+    offset = 0;
+    while (offset < snap->nodesSize) {
+        xmlNodePtr node = (xmlNodePtr) (base + offset);
+
+        node->doc = ret;
+        node->parent = xmlSnapshotReloc(node->parent, delta);
+        if (node->parent == NULL)
+            node->parent = (xmlNodePtr) ret;
+        node->next = xmlSnapshotReloc(node->next, delta);
+        node->prev = xmlSnapshotReloc(node->prev, delta);
+        if (node->ns != NULL)
+            node->ns = nsTab[XML_PTR_TO_INT(node->ns) - 1];
+
+        if (node->type == XML_ATTRIBUTE_NODE) {
+            node->children = xmlSnapshotReloc(node->children, delta);
+            node->last = xmlSnapshotReloc(node->last, delta);
+            offset += XML_SNAPSHOT_ATTR_SIZE;
+        } else {
+            if (node->type == XML_ENTITY_REF_NODE) {
+                node->children =
+                    (xmlNodePtr) xmlGetDocEntity(ret, node->name);
+                node->last = node->children;
+            } else {
+                node->children = xmlSnapshotReloc(node->children, delta);
+                node->last = xmlSnapshotReloc(node->last, delta);
             }
-            if (occur == 0) {
-                tmp = cur->next;
-                while (tmp != NULL && occur == 0) {
-		    if (tmp->type == XML_COMMENT_NODE)
-		        occur++;
-                    tmp = tmp->next;
-                }
-                if (occur != 0)
-                    occur = 1;
-            } else
-                occur++;
-        } else if ((cur->type == XML_TEXT_NODE) ||
-                   (cur->type == XML_CDATA_SECTION_NODE)) {
-            xmlBufCat(buf, BAD_CAST "/text()");
-
-            /*
-             * Thumbler index computation
-             */
-            tmp = cur->prev;
-            while (tmp != NULL) {
-                if ((tmp->type == XML_TEXT_NODE) ||
-		    (tmp->type == XML_CDATA_SECTION_NODE))
-		    occur++;
-                tmp = tmp->prev;
-            }
-	    /*
-	    * Evaluate if this is the only text- or CDATA-section-node;
-	    * if yes, then we'll get "text()", otherwise "text()[1]".
-	    */
-            if (occur == 0) {
-                tmp = cur->next;
-                while (tmp != NULL) {
-		    if ((tmp->type == XML_TEXT_NODE) ||
-			(tmp->type == XML_CDATA_SECTION_NODE))
-		    {
-			occur = 1;
-			break;
-		    }
-		    tmp = tmp->next;
-		}
-            } else
-                occur++;
-        } else if (cur->type == XML_PI_NODE) {
-            xmlBufCat(buf, BAD_CAST "/processing-instruction('");
-            xmlBufCat(buf, cur->name);
-            xmlBufCat(buf, BAD_CAST "')");
+            node->properties = xmlSnapshotReloc(node->properties, delta);
+            if (node->nsDef != NULL)
+                node->nsDef = nsTab[XML_PTR_TO_INT(node->nsDef) - 1];
+            if ((XML_PTR_TO_INT(node->content) >= start) &&
+                (XML_PTR_TO_INT(node->content) < end))
+                node->content += delta;
+            offset += XML_SNAPSHOT_NODE_SIZE;
+        }
 
-            /*
-             * Thumbler index computation
-             */
-            tmp = cur->prev;
-            while (tmp != NULL) {
-                if ((tmp->type == XML_PI_NODE) &&
-		    (xmlStrEqual(cur->name, tmp->name)))
-                    occur++;
-                tmp = tmp->prev;
-            }
-            if (occur == 0) {
-                tmp = cur->next;
-                while (tmp != NULL && occur == 0) {
-                    if ((tmp->type == XML_PI_NODE) &&
-			(xmlStrEqual(cur->name, tmp->name)))
-                        occur++;
-                    tmp = tmp->next;
-                }
-                if (occur != 0)
-                    occur = 1;
-            } else
-                occur++;
+        if ((xmlRegisterCallbacks) && (xmlRegisterNodeDefaultValue))
+            xmlRegisterNodeDefaultValue(node);
+    }
+    xmlFree(nsTab);
 
-        } else if (cur->type == XML_ATTRIBUTE_NODE) {
-            xmlBufCat(buf, BAD_CAST "/@");
-            if (cur->ns && cur->ns->prefix != NULL) {
-                xmlBufCat(buf, cur->ns->prefix);
-                xmlBufCat(buf, BAD_CAST ":");
-            }
-            xmlBufCat(buf, cur->name);
+    /*
+     * Link the top-level nodes and the internal subset
+     */
+    ret->children = xmlSnapshotReloc(snap->children, delta);
+    ret->last = xmlSnapshotReloc(snap->last, delta);
+    if (ret->intSubset != NULL) {
+        xmlNodePtr dtd = (xmlNodePtr) ret->intSubset;
+        xmlNodePtr prev = xmlSnapshotReloc(snap->dtdPrev, delta);
+
+        dtd->parent = (xmlNodePtr) ret;
+        dtd->prev = prev;
+        if (prev == NULL) {
+            dtd->next = ret->children;
+            ret->children = dtd;
         } else {
-            goto error;
+            dtd->next = prev->next;
+            prev->next = dtd;
         }
+        if (dtd->next == NULL)
+            ret->last = dtd;
+        else
+            dtd->next->prev = dtd;
+    }
 
-        if (occur > 0) {
-            char tmpbuf[30];
+    for (i = 0; i < snap->nbIds; i++) {
+        xmlAttrPtr attr = xmlSnapshotReloc(snap->idAttrs[i], delta);
 
-            snprintf(tmpbuf, sizeof(tmpbuf), "[%d]", occur);
-            xmlBufCat(buf, BAD_CAST tmpbuf);
-        }
+        if (xmlAddIDSafe(attr, snap->idValues[i]) < 0)
+            goto error;
     }
 
-    ret = xmlBufDetach(buf);
+    return(ret);
 
 error:
-    xmlBufFree(buf);
-    xmlFree(nodes);
-    return(ret);
+    xmlFreeDoc(ret);
+    return(NULL);
 }
 
 /**
- * Get the root element of the document.
+ * Free a document snapshot. Copies made from the snapshot aren't
+ * affected.
  *
- * Searches the document's children for the root element. The first
- * child is not necessarily the root element, but could also be a
- * DTD, comment or PI.
+ * @since 2.16.0
  *
- * @param doc  the document
- * @returns the root element or NULL if no element was found.
+ * @param snap  the snapshot
  */
-xmlNode *
-xmlDocGetRootElement(const xmlDoc *doc) {
-    xmlNodePtr ret;
+void
+xmlFreeDocSnapshot(xmlDocSnapshot *snap) {
+    int i;
 
-    if (doc == NULL) return(NULL);
-    ret = doc->children;
-    while (ret != NULL) {
-	if (ret->type == XML_ELEMENT_NODE)
-	    return(ret);
-        ret = ret->next;
+    if (snap == NULL)
+        return;
+
+    if (snap->idValues != NULL) {
+        for (i = 0; i < snap->nbIds; i++)
+            xmlFree(snap->idValues[i]);
+        xmlFree(snap->idValues);
     }
-    return(ret);
+    xmlFree(snap->idAttrs);
+    xmlFree(snap->nsTab);
+    xmlFree(snap->image);
+    xmlFreeDoc(snap->doc);
+    xmlFree(snap);
 }
 
 /**
- * If `root` is NULL no action is taken. To remove a node from a
- * document, use #xmlUnlinkNode instead.
- *
- * Set the root element of the document (`doc->children` is a list
- * containing possibly comments, PIs, etc ...).
+ * Estimate the memory used by a snapshot: the image and the frozen
+ * copy which is about the same size.
  *
- * `root` must be an element node. It is unlinked before insertion.
- *
- * @param doc  the document
- * @param root  the new document root element
- * @returns the unlinked old root element or NULL if the document
- * didn't have a root element or a memory allocation failed.
+ * @param snap  the snapshot
+ * @returns the size in bytes
  */
-xmlNode *
-xmlDocSetRootElement(xmlDoc *doc, xmlNode *root) {
-    xmlNodePtr old = NULL;
-
-    if (doc == NULL) return(NULL);
-    if ((root == NULL) || (root->type == XML_NAMESPACE_DECL))
-	return(NULL);
-    old = doc->children;
-    while (old != NULL) {
-	if (old->type == XML_ELEMENT_NODE)
-	    break;
-        old = old->next;
-    }
-    if (old == root)
-        return(old);
-    xmlUnlinkNodeInternal(root);
-    if (xmlSetTreeDoc(root, doc) < 0)
-        return(NULL);
-    root->parent = (xmlNodePtr) doc;
-    if (old == NULL) {
-	if (doc->children == NULL) {
-	    doc->children = root;
-	    doc->last = root;
-	} else {
-	    xmlAddSibling(doc->children, root);
-	}
-    } else {
-	xmlReplaceNode(old, root);
-    }
-    return(old);
+size_t
+xmlDocSnapshotSize(xmlDocSnapshot *snap) {
+    if (snap == NULL)
+        return(0);
+    return(sizeof(*snap) + 2 * snap->size);
 }
 
-/**
- * Set the `xml:lang` attribute of a node.
+/************************************************************************
+ *									*
+ *		Binary documents					*
+ *									*
+ ************************************************************************/
+
+#define XML_DOC_BIN_MAGIC "LXDB"
+#define XML_DOC_BIN_VERSION 1
+/* Flags of text nodes */
+#define XML_DOC_BIN_NOENC   (1u << 0)
+#define XML_DOC_BIN_INTERN  (1u << 1)
+/* Nesting limit of element content models */
+#define XML_DOC_BIN_MAX_DEPTH 2048
+
+/*
+ * The binary form of a document is a header, a string table with
+ * all names, prefixes and namespace URIs, a table of namespaces
+ * which aren't declared in the tree and the nodes in document order.
+ * Nodes start with their type and line number. Names, blanks and
+ * very short text are stored as an index into the string table,
+ * other text inline with its length. Attributes and children of
+ * elements follow the namespace declarations and the name, both
+ * lists end with a zero.
  *
- * @param cur  the node being changed
- * @param lang  the language description
- * @returns 0 on success, 1 if arguments are invalid, -1 if a
- * memory allocation failed.
+ * References to namespaces are zero for NULL, odd numbers for
+ * namespace declarations in document order and even numbers for
+ * the other namespaces, which become the oldNs list of the loaded
+ * document.
  */
-int
-xmlNodeSetLang(xmlNode *cur, const xmlChar *lang) {
+
+typedef struct {
     xmlNsPtr ns;
-    xmlAttrPtr attr;
-    int res;
+    xmlNodePtr owner;
+    int index;
+} xmlDocBinNs;
 
-    if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
-        return(1);
+typedef struct {
+    xmlBufPtr buf;
+    xmlHashTablePtr strings;
+    const xmlChar **strTab;
+    int nbStrings;
+    int maxStrings;
+    /* namespace declarations in scope */
+    xmlDocBinNs *nsTab;
+    int nbNs;
+    int maxNs;
+    int nbNsDefs;
+    /* namespaces without declaration in scope */
+    xmlNsPtr *foreign;
+    int nbForeign;
+    int maxForeign;
+    int error;
+} xmlDocBinWriter;
 
-    res = xmlSearchNsByHrefSafe(cur, XML_XML_NAMESPACE, &ns);
-    if (res != 0)
-        return(res);
-    attr = xmlSetNsProp(cur, ns, BAD_CAST "lang", lang);
-    if (attr == NULL)
-        return(-1);
+typedef struct {
+    xmlBinReader reader;
+    xmlDocPtr doc;
+    const xmlChar **strTab;
+    int nbStrings;
+    xmlNsPtr *nsTab;
+    int nbNsDefs;
+    int maxNsDefs;
+    xmlNsPtr *foreign;
+    int nbForeign;
+} xmlDocBinLoader;
 
-    return(0);
-}
+static int
+xmlDocBinWriteList(xmlDocBinWriter *w, xmlNodePtr top);
 
-/**
- * Find the `xml:lang` of a node.
- *
- * Look up the value of the `xml:lang` attribute or the one carried
- * by the nearest ancestor.
- *
- * @param cur  the node being checked
- * @returns a pointer to the lang value, or NULL if not found
- *     It's up to the caller to free the memory with #xmlFree.
+static int
+xmlDocBinReadList(xmlDocBinLoader *l, xmlNodePtr top);
+
+/*
+ * Text is written as its length plus one followed by its bytes,
+ * NULL as zero.
  */
-xmlChar *
-xmlNodeGetLang(const xmlNode *cur) {
-    xmlChar *lang;
-    int res;
+static void
+xmlDocBinWriteText(xmlBufPtr buf, const xmlChar *str) {
+    if (str == NULL) {
+        xmlBinWriteVarint(buf, 0);
+    } else {
+        int len = xmlStrlen(str);
 
-    if ((cur == NULL) || (cur->type == XML_NAMESPACE_DECL))
-        return(NULL);
+        xmlBinWriteVarint(buf, (unsigned) len + 1);
+        xmlBufAdd(buf, str, len);
+    }
+}
 
-    while (cur != NULL) {
-        res = xmlNodeGetAttrValue(cur, BAD_CAST "lang", XML_XML_NAMESPACE,
-                                  &lang);
-        if (res < 0)
-            return(NULL);
-	if (lang != NULL)
-	    return(lang);
+static void
+xmlDocBinWriteName(xmlDocBinWriter *w, const xmlChar *str) {
+    void *idx;
 
-	cur = cur->parent;
+    if (str == NULL) {
+        xmlBinWriteVarint(w->buf, 0);
+        return;
     }
 
-    return(NULL);
+    idx = xmlHashLookup(w->strings, str);
+    if (idx == NULL) {
+        if (w->nbStrings >= w->maxStrings) {
+            const xmlChar **tmp;
+            int newSize;
+
+            newSize = xmlGrowCapacity(w->maxStrings, sizeof(tmp[0]),
+                                      64, XML_MAX_ITEMS);
+            if (newSize < 0) {
+                w->error = 1;
+                return;
+            }
+            tmp = xmlRealloc(w->strTab, newSize * sizeof(tmp[0]));
+            if (tmp == NULL) {
+                w->error = 1;
+                return;
+            }
+            w->strTab = tmp;
+            w->maxStrings = newSize;
+        }
+        w->strTab[w->nbStrings++] = str;
+        idx = XML_INT_TO_PTR(w->nbStrings);
+        if (xmlHashAdd(w->strings, str, idx) < 0) {
+            w->error = 1;
+            return;
+        }
+    }
+    xmlBinWriteVarint(w->buf, XML_PTR_TO_INT(idx));
 }
 
+static int
+xmlDocBinAddForeign(xmlDocBinWriter *w, xmlNsPtr ns) {
+    int i;
 
-/**
- * Set the `xml:space` attribute of a node.
- *
- * @param cur  the node being changed
- * @param val  the xml:space value ("0": default, 1: "preserve")
- * @returns 0 on success, 1 if arguments are invalid, -1 if a
- * memory allocation failed.
- */
-int
-xmlNodeSetSpacePreserve(xmlNode *cur, int val) {
-    xmlNsPtr ns;
-    xmlAttrPtr attr;
-    const char *string;
-    int res;
+    for (i = 0; i < w->nbForeign; i++) {
+        if (w->foreign[i] == ns)
+            return(i);
+    }
 
-    if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
-        return(1);
+    if (w->nbForeign >= w->maxForeign) {
+        xmlNsPtr *tmp;
+        int newSize;
 
-    res = xmlSearchNsByHrefSafe(cur, XML_XML_NAMESPACE, &ns);
-    if (res != 0)
-	return(res);
+        newSize = xmlGrowCapacity(w->maxForeign, sizeof(tmp[0]),
+                                  4, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            w->error = 1;
+            return(0);
+        }
+        tmp = xmlRealloc(w->foreign, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            w->error = 1;
+            return(0);
+        }
+        w->foreign = tmp;
+        w->maxForeign = newSize;
+    }
+    w->foreign[w->nbForeign] = ns;
+    return(w->nbForeign++);
+}
 
-    if (val == 0)
-        string = "default";
-    else
-        string = "preserve";
+static void
+xmlDocBinWriteNsRef(xmlDocBinWriter *w, xmlNsPtr ns) {
+    int i;
 
-    attr = xmlSetNsProp(cur, ns, BAD_CAST "space", BAD_CAST string);
-    if (attr == NULL)
-        return(-1);
+    if (ns == NULL) {
+        xmlBinWriteVarint(w->buf, 0);
+        return;
+    }
 
-    return(0);
+    for (i = w->nbNs - 1; i >= 0; i--) {
+        if (w->nsTab[i].ns == ns) {
+            xmlBinWriteVarint(w->buf, 2 * (unsigned) w->nsTab[i].index + 1);
+            return;
+        }
+    }
+
+    i = xmlDocBinAddForeign(w, ns);
+    xmlBinWriteVarint(w->buf, 2 * (unsigned) i + 2);
 }
 
-/**
- * Find the `xml:space` of a node.
- *
- * Look up the value of the `xml:space` attribute or the one carried
- * by the nearest ancestor.
- *
- * @param cur  the node being checked
- * @returns -1 if xml:space is not inherited, 0 if "default", 1 if "preserve"
- */
-int
-xmlNodeGetSpacePreserve(const xmlNode *cur) {
-    xmlChar *space;
-        int res;
+static void
+xmlDocBinPushNs(xmlDocBinWriter *w, xmlNsPtr ns, xmlNodePtr owner) {
+    if (w->nbNs >= w->maxNs) {
+        xmlDocBinNs *tmp;
+        int newSize;
 
-    if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
+        newSize = xmlGrowCapacity(w->maxNs, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            w->error = 1;
+            return;
+        }
+        tmp = xmlRealloc(w->nsTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            w->error = 1;
+            return;
+        }
+        w->nsTab = tmp;
+        w->maxNs = newSize;
+    }
+    w->nsTab[w->nbNs].ns = ns;
+    w->nsTab[w->nbNs].owner = owner;
+    w->nsTab[w->nbNs].index = w->nbNsDefs++;
+    w->nbNs++;
+}
+
+static void
+xmlDocBinPopNs(xmlDocBinWriter *w, xmlNodePtr owner) {
+    while ((w->nbNs > 0) && (w->nsTab[w->nbNs - 1].owner == owner))
+        w->nbNs--;
+}
+
+/*
+ * Content models are written in preorder. The second operand of
+ * sequences and choices follows the first one without nesting, so
+ * that long lists don't recurse.
+ */
+static int
+xmlDocBinWriteContent(xmlDocBinWriter *w, xmlElementContentPtr content,
+                      int depth) {
+    if (depth > XML_DOC_BIN_MAX_DEPTH)
         return(-1);
 
-    while (cur != NULL) {
-	res = xmlNodeGetAttrValue(cur, BAD_CAST "space", XML_XML_NAMESPACE,
-                                  &space);
-        if (res < 0)
+    while (content != NULL) {
+        xmlBinWriteVarint(w->buf, content->type);
+        xmlBinWriteVarint(w->buf, content->ocur);
+        xmlDocBinWriteName(w, content->name);
+        xmlDocBinWriteName(w, content->prefix);
+        if ((content->type != XML_ELEMENT_CONTENT_SEQ) &&
+            (content->type != XML_ELEMENT_CONTENT_OR))
+            return(0);
+        if (xmlDocBinWriteContent(w, content->c1, depth + 1) < 0)
             return(-1);
-	if (space != NULL) {
-	    if (xmlStrEqual(space, BAD_CAST "preserve")) {
-		xmlFree(space);
-		return(1);
-	    }
-	    if (xmlStrEqual(space, BAD_CAST "default")) {
-		xmlFree(space);
-		return(0);
-	    }
-	    xmlFree(space);
-	}
-
-	cur = cur->parent;
+        content = content->c2;
     }
+    xmlBinWriteVarint(w->buf, 0);
 
-    return(-1);
+    return(0);
 }
 
-/**
- * Set (or reset) the name of a node.
- *
- * @param cur  the node being changed
- * @param name  the new tag name
+static void
+xmlDocBinWriteNotation(void *payload, void *data,
+                       const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlNotationPtr nota = payload;
+    xmlDocBinWriter *w = data;
+
+    xmlDocBinWriteName(w, nota->name);
+    xmlDocBinWriteText(w->buf, nota->PublicID);
+    xmlDocBinWriteText(w->buf, nota->SystemID);
+}
+
+/*
+ * Only the internal subset is written, declarations from the
+ * external subset are lost.
  */
-void
-xmlNodeSetName(xmlNode *cur, const xmlChar *name) {
-    xmlDocPtr doc;
-    xmlDictPtr dict;
-    const xmlChar *copy;
-    const xmlChar *oldName;
+static int
+xmlDocBinWriteDtd(xmlDocBinWriter *w, xmlDtdPtr dtd) {
+    xmlNodePtr cur;
 
-    if (cur == NULL) return;
-    if (name == NULL) return;
-    switch(cur->type) {
-        case XML_ELEMENT_NODE:
-        case XML_ATTRIBUTE_NODE:
-        case XML_PI_NODE:
-        case XML_ENTITY_REF_NODE:
-	    break;
-        default:
-            return;
+    xmlDocBinWriteText(w->buf, dtd->name);
+    xmlDocBinWriteText(w->buf, dtd->ExternalID);
+    xmlDocBinWriteText(w->buf, dtd->SystemID);
+
+    for (cur = dtd->children; cur != NULL; cur = cur->next) {
+        switch (cur->type) {
+            case XML_ELEMENT_DECL: {
+                xmlElementPtr elem = (xmlElementPtr) cur;
+
+                if (elem->etype == XML_ELEMENT_TYPE_UNDEFINED)
+                    break;
+                xmlBinWriteVarint(w->buf, cur->type);
+                xmlDocBinWriteName(w, elem->name);
+                xmlDocBinWriteName(w, elem->prefix);
+                xmlBinWriteVarint(w->buf, elem->etype);
+                if (xmlDocBinWriteContent(w, elem->content, 0) < 0)
+                    return(-1);
+                break;
+            }
+
+            case XML_ATTRIBUTE_DECL: {
+                xmlAttributePtr attr = (xmlAttributePtr) cur;
+                xmlEnumerationPtr e;
+
+                xmlBinWriteVarint(w->buf, cur->type);
+                xmlDocBinWriteName(w, attr->elem);
+                xmlDocBinWriteName(w, attr->name);
+                xmlDocBinWriteName(w, attr->prefix);
+                xmlBinWriteVarint(w->buf, attr->atype);
+                xmlBinWriteVarint(w->buf, attr->def);
+                xmlDocBinWriteText(w->buf, attr->defaultValue);
+                for (e = attr->tree; e != NULL; e = e->next)
+                    xmlDocBinWriteName(w, e->name);
+                xmlBinWriteVarint(w->buf, 0);
+                break;
+            }
+
+            case XML_ENTITY_DECL: {
+                xmlEntityPtr ent = (xmlEntityPtr) cur;
+
+                if (ent->etype == XML_INTERNAL_PREDEFINED_ENTITY)
+                    break;
+                xmlBinWriteVarint(w->buf, cur->type);
+                xmlDocBinWriteName(w, ent->name);
+                xmlBinWriteVarint(w->buf, ent->etype);
+                xmlDocBinWriteText(w->buf, ent->ExternalID);
+                xmlDocBinWriteText(w->buf, ent->SystemID);
+                xmlDocBinWriteText(w->buf, ent->content);
+                xmlDocBinWriteText(w->buf, ent->orig);
+                xmlDocBinWriteText(w->buf, ent->URI);
+                xmlBinWriteVarint(w->buf, ent->flags &
+                    (XML_ENT_PARSED | XML_ENT_CHECKED | XML_ENT_VALIDATED));
+                if (xmlDocBinWriteList(w, cur) < 0)
+                    return(-1);
+                break;
+            }
+
+            case XML_COMMENT_NODE:
+                xmlBinWriteVarint(w->buf, cur->type);
+                xmlBinWriteVarint(w->buf, cur->line);
+                xmlDocBinWriteText(w->buf, cur->content);
+                break;
+
+            case XML_PI_NODE:
+                xmlBinWriteVarint(w->buf, cur->type);
+                xmlBinWriteVarint(w->buf, cur->line);
+                xmlDocBinWriteName(w, cur->name);
+                xmlDocBinWriteText(w->buf, cur->content);
+                break;
+
+            default:
+                return(-1);
+        }
     }
+    xmlBinWriteVarint(w->buf, 0);
 
-    doc = cur->doc;
-    if (doc != NULL)
-	dict = doc->dict;
-    else
-        dict = NULL;
+    if (dtd->notations != NULL) {
+        xmlBinWriteVarint(w->buf, xmlHashSize(dtd->notations));
+        xmlHashScan(dtd->notations, xmlDocBinWriteNotation, w);
+    } else {
+        xmlBinWriteVarint(w->buf, 0);
+    }
 
-    if (dict != NULL)
-        copy = xmlDictLookup(dict, name, -1);
-    else
-        copy = xmlStrdup(name);
-    if (copy == NULL)
-        return;
+    return(0);
+}
 
-    oldName = cur->name;
-    cur->name = copy;
-    if ((oldName != NULL) &&
-        ((dict == NULL) || (!xmlDictOwns(dict, oldName))))
-        xmlFree((xmlChar *) oldName);
+/*
+ * Like the parser, store formatting blanks and very short text in
+ * the dictionary.
+ */
+static int
+xmlDocBinInternText(const xmlChar *str) {
+    int len = 0;
+
+    if (str == NULL)
+        return(0);
+    while ((len < 60) && (IS_BLANK_CH(str[len])))
+        len++;
+    if (str[len] == 0)
+        return(1);
+    return((str[1] == 0) || (str[2] == 0) || (str[3] == 0));
 }
 
-/**
- * Set (or reset) the base URI of a node, i.e. the value of the
- * `xml:base` attribute.
- *
- * @param cur  the node being changed
- * @param uri  the new base URI
- * @returns 0 on success, -1 on error.
+/*
+ * Write a node without its children.
  */
-int
-xmlNodeSetBase(xmlNode *cur, const xmlChar* uri) {
-    xmlNsPtr ns;
-    xmlChar* fixed;
+static int
+xmlDocBinWriteNode(xmlDocBinWriter *w, xmlNodePtr cur) {
+    xmlBinWriteVarint(w->buf, cur->type);
+    xmlBinWriteVarint(w->buf, cur->line);
 
-    if (cur == NULL)
-        return(-1);
-    switch(cur->type) {
+    switch (cur->type) {
         case XML_ELEMENT_NODE:
-        case XML_ATTRIBUTE_NODE:
-	    break;
-        case XML_DOCUMENT_NODE:
-        case XML_HTML_DOCUMENT_NODE: {
-	    xmlDocPtr doc = (xmlDocPtr) cur;
+        case XML_XINCLUDE_START:
+        case XML_XINCLUDE_END: {
+            xmlAttrPtr attr;
+            xmlNsPtr ns;
+            xmlNodePtr child;
+            int nbNs = 0;
 
-	    if (doc->URL != NULL)
-		xmlFree(doc->URL);
-	    if (uri == NULL) {
-		doc->URL = NULL;
-            } else {
-		doc->URL = xmlPathToURI(uri);
-                if (doc->URL == NULL)
+            if (cur->name == NULL)
+                return(-1);
+
+            /* Declarations first, the element can be in their scope */
+            for (ns = cur->nsDef; ns != NULL; ns = ns->next)
+                nbNs++;
+            xmlBinWriteVarint(w->buf, nbNs);
+            for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+                xmlDocBinPushNs(w, ns, cur);
+                xmlDocBinWriteName(w, ns->prefix);
+                xmlDocBinWriteName(w, ns->href);
+            }
+
+            xmlDocBinWriteName(w, cur->name);
+            xmlDocBinWriteNsRef(w, cur->ns);
+
+            for (attr = cur->properties; attr != NULL; attr = attr->next) {
+                if (attr->name == NULL)
                     return(-1);
+                xmlDocBinWriteName(w, attr->name);
+                xmlDocBinWriteNsRef(w, attr->ns);
+                xmlBinWriteVarint(w->buf, attr->atype);
+                for (child = attr->children; child != NULL;
+                     child = child->next) {
+                    if (((child->type != XML_TEXT_NODE) &&
+                         (child->type != XML_ENTITY_REF_NODE)) ||
+                        (xmlDocBinWriteNode(w, child) < 0))
+                        return(-1);
+                }
+                xmlBinWriteVarint(w->buf, 0);
             }
-	    return(0);
-	}
+            xmlBinWriteVarint(w->buf, 0);
+            break;
+        }
+
+        case XML_TEXT_NODE: {
+            int flags = 0;
+
+            if (cur->name == xmlStringTextNoenc)
+                flags |= XML_DOC_BIN_NOENC;
+            if (xmlDocBinInternText(cur->content))
+                flags |= XML_DOC_BIN_INTERN;
+            xmlBinWriteVarint(w->buf, flags);
+            if (flags & XML_DOC_BIN_INTERN)
+                xmlDocBinWriteName(w, cur->content);
+            else
+                xmlDocBinWriteText(w->buf, cur->content);
+            break;
+        }
+
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+            xmlDocBinWriteText(w->buf, cur->content);
+            break;
+
+        case XML_PI_NODE:
+            xmlDocBinWriteName(w, cur->name);
+            xmlDocBinWriteText(w->buf, cur->content);
+            break;
+
+        case XML_ENTITY_REF_NODE:
+            xmlDocBinWriteName(w, cur->name);
+            break;
+
+        case XML_DTD_NODE:
+            if (cur != (xmlNodePtr) cur->doc->intSubset)
+                return(-1);
+            return(xmlDocBinWriteDtd(w, (xmlDtdPtr) cur));
+
         default:
-	    return(-1);
+            return(-1);
     }
 
-    xmlSearchNsByHrefSafe(cur, XML_XML_NAMESPACE, &ns);
-    if (ns == NULL)
-	return(-1);
-    fixed = xmlPathToURI(uri);
-    if (fixed == NULL)
-        return(-1);
-    if (xmlSetNsProp(cur, ns, BAD_CAST "base", fixed) == NULL) {
-        xmlFree(fixed);
-        return(-1);
+    return(0);
+}
+
+/*
+ * Write the children of a document or entity and their descendants.
+ */
+static int
+xmlDocBinWriteList(xmlDocBinWriter *w, xmlNodePtr top) {
+    xmlNodePtr cur = top->children;
+
+    while (cur != NULL) {
+        if ((xmlDocBinWriteNode(w, cur) < 0) || (w->error))
+            return(-1);
+
+        if ((cur->type == XML_ELEMENT_NODE) ||
+            (cur->type == XML_XINCLUDE_START) ||
+            (cur->type == XML_XINCLUDE_END)) {
+            if (cur->children != NULL) {
+                cur = cur->children;
+                continue;
+            }
+            xmlBinWriteVarint(w->buf, 0);
+            xmlDocBinPopNs(w, cur);
+        }
+
+        while (cur->next == NULL) {
+            cur = cur->parent;
+            if (cur == NULL)
+                return(-1);
+            if (cur == top)
+                break;
+            xmlBinWriteVarint(w->buf, 0);
+            xmlDocBinPopNs(w, cur);
+        }
+        if (cur == top)
+            break;
+        cur = cur->next;
     }
-    xmlFree(fixed);
+    xmlBinWriteVarint(w->buf, 0);
 
     return(0);
 }
 
 /**
- * Searches for the base URI. The code should work on both XML
- * and HTML document even if base mechanisms are completely different.
- * It returns the base as defined in RFC 2396 sections "5.1.1. Base
- * URI within Document Content" and "5.1.2. Base URI from the
- * Encapsulating Entity". However it does not return the document base
- * (5.1.3), use `doc->URL` in this case.
+ * Serialize a document to a compact binary form which can be
+ * loaded with #xmlDocLoadBinaryMemory much faster than parsing the
+ * document. Names are stored only once, text and attribute values
+ * are stored unescaped in UTF-8.
  *
- * @since 2.13.0
+ * Element, attribute, entity and notation declarations of the
+ * internal subset are kept, the external subset is not. The format
+ * is only readable by the same version of the library.
  *
- * @param doc  the document the node pertains to
- * @param cur  the node being checked
- * @param baseOut  pointer to base
- * @returns 0 in case of success, 1 if a URI or argument is invalid, -1 if a
- * memory allocation failed.
+ * @since 2.16.0
+ * @param doc  the document
+ * @param mem  pointer to the resulting buffer, to be freed with xmlFree
+ * @param size  pointer to the size of the buffer
+ * @returns 0 on success, -1 if the document contains unsupported
+ * nodes or a memory allocation failed.
  */
 int
-xmlNodeGetBaseSafe(const xmlDoc *doc, const xmlNode *cur, xmlChar **baseOut) {
-    xmlChar *ret = NULL;
-    xmlChar *base, *newbase;
-    int res;
+xmlDocSaveBinaryMemory(xmlDoc *doc, xmlChar **mem, int *size) {
+    xmlDocBinWriter w;
+    xmlBufPtr out = NULL, foreign = NULL;
+    xmlNsPtr ns;
+    size_t len;
+    int i, ret = -1;
+
+    if (mem != NULL)
+        *mem = NULL;
+    if (size != NULL)
+        *size = 0;
+    if ((doc == NULL) || (mem == NULL) || (size == NULL) ||
+        ((doc->type != XML_DOCUMENT_NODE) &&
+         (doc->type != XML_HTML_DOCUMENT_NODE)))
+        return(-1);
 
-    if (baseOut == NULL)
-        return(1);
-    *baseOut = NULL;
-    if ((cur == NULL) && (doc == NULL))
-        return(1);
-    if ((cur != NULL) && (cur->type == XML_NAMESPACE_DECL))
-        return(1);
-    if (doc == NULL)
-        doc = cur->doc;
+    memset(&w, 0, sizeof(w));
+    w.buf = xmlBufCreate(4096);
+    w.strings = xmlHashCreate(0);
+    out = xmlBufCreate(4096);
+    foreign = xmlBufCreate(64);
+    if ((w.buf == NULL) || (w.strings == NULL) || (out == NULL) ||
+        (foreign == NULL))
+        goto done;
 
-    if ((doc != NULL) && (doc->type == XML_HTML_DOCUMENT_NODE)) {
-        cur = doc->children;
-	while ((cur != NULL) && (cur->name != NULL)) {
-	    if (cur->type != XML_ELEMENT_NODE) {
-	        cur = cur->next;
-		continue;
-	    }
-	    if (!xmlStrcasecmp(cur->name, BAD_CAST "html")) {
-	        cur = cur->children;
-		continue;
-	    }
-	    if (!xmlStrcasecmp(cur->name, BAD_CAST "head")) {
-	        cur = cur->children;
-		continue;
-	    }
-	    if (!xmlStrcasecmp(cur->name, BAD_CAST "base")) {
-                if (xmlNodeGetAttrValue(cur, BAD_CAST "href", NULL, &ret) < 0)
-                    return(-1);
-                if (ret == NULL)
-                    return(1);
-                goto found;
-	    }
-	    cur = cur->next;
-	}
-	return(0);
-    }
+    /* Keep the order of the oldNs list */
+    for (ns = doc->oldNs; ns != NULL; ns = ns->next)
+        xmlDocBinAddForeign(&w, ns);
 
-    while (cur != NULL) {
-	if (cur->type == XML_ENTITY_DECL) {
-	    xmlEntityPtr ent = (xmlEntityPtr) cur;
+    if ((xmlDocBinWriteList(&w, (xmlNodePtr) doc) < 0) || (w.error) ||
+        (xmlBufContent(w.buf) == NULL))
+        goto done;
 
-            if (ent->URI == NULL)
-                break;
-            xmlFree(ret);
-	    ret = xmlStrdup(ent->URI);
-            if (ret == NULL)
-                return(-1);
-            goto found;
-	}
-	if (cur->type == XML_ELEMENT_NODE) {
-	    if (xmlNodeGetAttrValue(cur, BAD_CAST "base", XML_XML_NAMESPACE,
-                                    &base) < 0) {
-                xmlFree(ret);
-                return(-1);
-            }
-	    if (base != NULL) {
-		if (ret != NULL) {
-		    res = xmlBuildURISafe(ret, base, &newbase);
-                    xmlFree(ret);
-                    xmlFree(base);
-                    if (res != 0)
-                        return(res);
-		    ret = newbase;
-		} else {
-		    ret = base;
-		}
-		if ((!xmlStrncmp(ret, BAD_CAST "http://", 7)) ||
-		    (!xmlStrncmp(ret, BAD_CAST "ftp://", 6)) ||
-		    (!xmlStrncmp(ret, BAD_CAST "urn:", 4)))
-                    goto found;
-	    }
-	}
-	cur = cur->parent;
-    }
+    /*
+     * The names of namespaces without declaration have to be added
+     * to the string table, too.
+     */
+    xmlBinWriteVarint(foreign, w.nbForeign);
+    {
+        xmlBufPtr body = w.buf;
 
-    if ((doc != NULL) && (doc->URL != NULL)) {
-	if (ret == NULL) {
-	    ret = xmlStrdup(doc->URL);
-            if (ret == NULL)
-                return(-1);
-        } else {
-            res = xmlBuildURISafe(ret, doc->URL, &newbase);
-            xmlFree(ret);
-            if (res != 0)
-                return(res);
-            ret = newbase;
+        w.buf = foreign;
+        for (i = 0; i < w.nbForeign; i++) {
+            xmlDocBinWriteName(&w, w.foreign[i]->prefix);
+            xmlDocBinWriteName(&w, w.foreign[i]->href);
         }
+        w.buf = body;
     }
+    if ((w.error) || (xmlBufContent(foreign) == NULL))
+        goto done;
 
-found:
-    *baseOut = ret;
-    return(0);
-}
-
-/**
- * See #xmlNodeGetBaseSafe. This function doesn't allow to distinguish
- * memory allocation failures from a non-existing base.
- *
- * @param doc  the document the node pertains to
- * @param cur  the node being checked
- * @returns a pointer to the base URL, or NULL if not found
- *     It's up to the caller to free the memory with #xmlFree.
- */
-xmlChar *
-xmlNodeGetBase(const xmlDoc *doc, const xmlNode *cur) {
-    xmlChar *base;
+    xmlBufAdd(out, BAD_CAST XML_DOC_BIN_MAGIC, 4);
+    xmlBinWriteInt(out, XML_DOC_BIN_VERSION);
+    xmlBinWriteInt(out, doc->type);
+    xmlBinWriteInt(out, doc->standalone);
+    xmlBinWriteInt(out, doc->properties);
+    xmlBinWriteInt(out, doc->parseFlags);
+    xmlBinWriteString(out, doc->version);
+    xmlBinWriteString(out, doc->encoding);
+    xmlBinWriteString(out, doc->URL);
+    xmlBinWriteVarint(out, w.nbStrings);
+    for (i = 0; i < w.nbStrings; i++)
+        xmlDocBinWriteText(out, w.strTab[i]);
+    xmlBufAdd(out, xmlBufContent(foreign), xmlBufUse(foreign));
+    xmlBinWriteVarint(out, w.nbNsDefs);
+    xmlBufAdd(out, xmlBufContent(w.buf), xmlBufUse(w.buf));
+
+    len = xmlBufUse(out);
+    if (len > INT_MAX)
+        goto done;
+    *mem = xmlBufDetach(out);
+    if (*mem == NULL)
+        goto done;
+    *size = len;
+    ret = 0;
 
-    xmlNodeGetBaseSafe(doc, cur, &base);
-    return(base);
+done:
+    xmlBufFree(out);
+    xmlBufFree(foreign);
+    xmlBufFree(w.buf);
+    xmlHashFree(w.strings, NULL);
+    xmlFree(w.strTab);
+    xmlFree(w.nsTab);
+    xmlFree(w.foreign);
+    return(ret);
 }
 
+#ifdef LIBXML_OUTPUT_ENABLED
 /**
- * Append the string value of a node to `buffer`. For text nodes,
- * the string value is the text content. Otherwise, the string value
- * is the concatenation of the string values of the node's
- * descendants.
- *
- * Entity references are substituted.
+ * Serialize a document to a file in binary form, see
+ * #xmlDocSaveBinaryMemory.
  *
- * @param buffer  a buffer
- * @param cur  the node being read
- * @returns 0 in case of success and -1 in case of error.
+ * @since 2.16.0
+ * @param doc  the document
+ * @param filename  the file name or URI
+ * @returns 0 on success, -1 in case of error.
  */
 int
-xmlNodeBufGetContent(xmlBuffer *buffer, const xmlNode *cur)
-{
-    xmlBufPtr buf;
-    int ret1, ret2;
+xmlDocSaveBinary(xmlDoc *doc, const char *filename) {
+    xmlOutputBufferPtr out;
+    xmlChar *mem;
+    int size;
 
-    if ((cur == NULL) || (buffer == NULL)) return(-1);
-    buf = xmlBufFromBuffer(buffer);
-    ret1 = xmlBufGetNodeContent(buf, cur);
-    ret2 = xmlBufBackToBuffer(buf, buffer);
-    if ((ret1 < 0) || (ret2 < 0))
+    if (filename == NULL)
+        return(-1);
+    if (xmlDocSaveBinaryMemory(doc, &mem, &size) < 0)
+        return(-1);
+    out = xmlOutputBufferCreateFilename(filename, NULL, 0);
+    if (out == NULL) {
+        xmlFree(mem);
+        return(-1);
+    }
+    xmlOutputBufferWrite(out, size, (const char *) mem);
+    xmlFree(mem);
+    if (xmlOutputBufferClose(out) < 0)
         return(-1);
     return(0);
 }
+#endif /* LIBXML_OUTPUT_ENABLED */
 
-static void
-xmlBufGetEntityRefContent(xmlBufPtr buf, const xmlNode *ref) {
-    xmlEntityPtr ent;
-
-    if (ref->children != NULL) {
-        ent = (xmlEntityPtr) ref->children;
-    } else {
-        /* lookup entity declaration */
-        ent = xmlGetDocEntity(ref->doc, ref->name);
-        if (ent == NULL)
-            return;
-    }
+/*
+ * Returns a pointer into the input and stores the length in `len`,
+ * or returns NULL for NULL text and errors.
+ */
+static const xmlChar *
+xmlDocBinReadText(xmlDocBinLoader *l, int *len) {
+    const xmlChar *ret;
+    unsigned n;
 
-    /*
-     * The parser should always expand predefined entities but it's
-     * possible to create references to predefined entities using
-     * the tree API.
-     */
-    if (ent->etype == XML_INTERNAL_PREDEFINED_ENTITY) {
-        xmlBufCat(buf, ent->content);
-        return;
+    *len = 0;
+    n = xmlBinReadVarint(&l->reader);
+    if (n == 0)
+        return(NULL);
+    n--;
+    if ((n > INT_MAX) || ((size_t) (l->reader.end - l->reader.cur) < n)) {
+        l->reader.error = 1;
+        l->reader.cur = l->reader.end;
+        return(NULL);
     }
+    ret = l->reader.cur;
+    l->reader.cur += n;
+    *len = n;
+    return(ret);
+}
 
-    if (ent->flags & XML_ENT_EXPANDING)
-        return;
+static xmlChar *
+xmlDocBinReadStrdup(xmlDocBinLoader *l) {
+    const xmlChar *str;
+    xmlChar *ret;
+    int len;
 
-    ent->flags |= XML_ENT_EXPANDING;
-    xmlBufGetChildContent(buf, (xmlNodePtr) ent);
-    ent->flags &= ~XML_ENT_EXPANDING;
+    str = xmlDocBinReadText(l, &len);
+    if (str == NULL)
+        return(NULL);
+    ret = xmlStrndup(str, len);
+    if (ret == NULL)
+        l->reader.error = 1;
+    return(ret);
 }
 
-static void
-xmlBufGetChildContent(xmlBufPtr buf, const xmlNode *tree) {
-    const xmlNode *cur = tree->children;
-
-    while (cur != NULL) {
-        switch (cur->type) {
-            case XML_TEXT_NODE:
-            case XML_CDATA_SECTION_NODE:
-                xmlBufCat(buf, cur->content);
-                break;
+static const xmlChar *
+xmlDocBinReadName(xmlDocBinLoader *l) {
+    unsigned idx = xmlBinReadVarint(&l->reader);
 
-            case XML_ENTITY_REF_NODE:
-                xmlBufGetEntityRefContent(buf, cur);
-                break;
+    if (idx == 0)
+        return(NULL);
+    if (idx > (unsigned) l->nbStrings) {
+        l->reader.error = 1;
+        return(NULL);
+    }
+    return(l->strTab[idx - 1]);
+}
 
-            default:
-                if (cur->children != NULL) {
-                    cur = cur->children;
-                    continue;
-                }
-                break;
-        }
+static xmlNsPtr
+xmlDocBinReadNsRef(xmlDocBinLoader *l) {
+    unsigned ref = xmlBinReadVarint(&l->reader);
+    unsigned idx;
 
-        while (cur->next == NULL) {
-            cur = cur->parent;
-            if (cur == tree)
-                return;
-        }
-        cur = cur->next;
+    if (ref == 0)
+        return(NULL);
+    if (ref & 1) {
+        idx = ref / 2;
+        if (idx < (unsigned) l->nbNsDefs)
+            return(l->nsTab[idx]);
+    } else {
+        idx = ref / 2 - 1;
+        if (idx < (unsigned) l->nbForeign)
+            return(l->foreign[idx]);
     }
+    l->reader.error = 1;
+    return(NULL);
 }
 
-/**
- * Append the string value of a node to `buf`. For text nodes,
- * the string value is the text content. Otherwise, the string value
- * is the concatenation of the string values of the node's
- * descendants.
- *
- * Entity references are substituted.
- *
- * @param buf  a buffer xmlBuf
- * @param cur  the node being read
- * @returns 0 in case of success and -1 in case of error.
+/*
+ * Fails if a count exceeds the remaining input, assuming each item
+ * takes at least `minSize` bytes.
  */
-int
-xmlBufGetNodeContent(xmlBuf *buf, const xmlNode *cur)
-{
-    if ((cur == NULL) || (buf == NULL))
-        return(-1);
-
-    switch (cur->type) {
-        case XML_DOCUMENT_NODE:
-        case XML_HTML_DOCUMENT_NODE:
-        case XML_DOCUMENT_FRAG_NODE:
-        case XML_ELEMENT_NODE:
-        case XML_ATTRIBUTE_NODE:
-        case XML_ENTITY_DECL:
-            xmlBufGetChildContent(buf, cur);
-            break;
+static unsigned
+xmlDocBinReadCount(xmlDocBinLoader *l, unsigned minSize) {
+    unsigned n = xmlBinReadVarint(&l->reader);
 
-        case XML_CDATA_SECTION_NODE:
-        case XML_TEXT_NODE:
-        case XML_COMMENT_NODE:
-        case XML_PI_NODE:
-	    xmlBufCat(buf, cur->content);
-            break;
+    if ((n > XML_MAX_ITEMS) ||
+        ((size_t) (l->reader.end - l->reader.cur) / minSize < n)) {
+        l->reader.error = 1;
+        return(0);
+    }
+    return(n);
+}
 
-        case XML_ENTITY_REF_NODE:
-            xmlBufGetEntityRefContent(buf, cur);
-            break;
+static xmlNodePtr
+xmlDocBinNewNode(xmlDocPtr doc, xmlElementType type, const xmlChar *name,
+                 const xmlChar *content, int len) {
+    xmlNodePtr cur;
 
-        case XML_NAMESPACE_DECL:
-	    xmlBufCat(buf, ((xmlNsPtr) cur)->href);
-	    break;
+    cur = (xmlNodePtr) xmlTreeAlloc(doc, sizeof(xmlNode));
+    if (cur == NULL)
+        return(NULL);
+    memset(cur, 0, sizeof(xmlNode));
+    cur->type = type;
+    cur->doc = doc;
+    cur->name = name;
 
-        default:
-            break;
+    if (content != NULL) {
+        cur->content = xmlTreeStrndup(doc, content, len);
+        if (cur->content == NULL) {
+            xmlTreeFree(doc, cur);
+            return(NULL);
+        }
     }
 
-    return(0);
+    if ((xmlRegisterCallbacks) && (xmlRegisterNodeDefaultValue))
+        xmlRegisterNodeDefaultValue(cur);
+    return(cur);
 }
 
-/**
- * Returns the string value of a node. For text nodes, the string
- * value is the text content. Otherwise, the string value is the
- * concatenation of the string values of the node's descendants.
- *
- * Entity references are substituted.
- *
- * It's up to the caller to free the result with #xmlFree.
- *
- * @param cur  the node being read
- * @returns a new string or NULL if arguments are invalid or a
- * memory allocation failed.
- */
-xmlChar *
-xmlNodeGetContent(const xmlNode *cur)
-{
-    xmlBufPtr buf;
-    xmlChar *ret;
+static void
+xmlDocBinAppend(xmlNodePtr parent, xmlNodePtr cur) {
+    cur->parent = parent;
+    if (parent->last == NULL) {
+        parent->children = cur;
+    } else {
+        parent->last->next = cur;
+        cur->prev = parent->last;
+    }
+    parent->last = cur;
+}
+
+static xmlNodePtr
+xmlDocBinReadNode(xmlDocBinLoader *l, unsigned type);
+
+static xmlAttrPtr
+xmlDocBinReadAttr(xmlDocBinLoader *l, xmlNodePtr elem,
+                  const xmlChar *name) {
+    xmlAttrPtr attr;
+    xmlNodePtr child;
+    unsigned atype, type;
+
+    attr = xmlMalloc(sizeof(xmlAttr));
+    if (attr == NULL) {
+        l->reader.error = 1;
+        return(NULL);
+    }
+    memset(attr, 0, sizeof(xmlAttr));
+    attr->type = XML_ATTRIBUTE_NODE;
+    attr->name = name;
+    attr->doc = l->doc;
+    attr->parent = elem;
+    attr->ns = xmlDocBinReadNsRef(l);
+    atype = xmlBinReadVarint(&l->reader);
+
+    if ((xmlRegisterCallbacks) && (xmlRegisterNodeDefaultValue))
+        xmlRegisterNodeDefaultValue((xmlNodePtr) attr);
+
+    while (!l->reader.error) {
+        type = xmlBinReadVarint(&l->reader);
+        if (type == 0)
+            break;
+        if ((type != XML_TEXT_NODE) && (type != XML_ENTITY_REF_NODE)) {
+            l->reader.error = 1;
+            break;
+        }
+        child = xmlDocBinReadNode(l, type);
+        if (child == NULL)
+            break;
+        xmlDocBinAppend((xmlNodePtr) attr, child);
+    }
+    if ((l->reader.error) || (atype > XML_ATTRIBUTE_NOTATION))
+        goto error;
+
+    if (atype == XML_ATTRIBUTE_ID) {
+        xmlChar *value = NULL;
+        int res;
+
+        if ((attr->children != NULL) &&
+            (attr->children->type == XML_TEXT_NODE) &&
+            (attr->children->next == NULL)) {
+            res = xmlAddIDSafe(attr, attr->children->content);
+        } else {
+            value = xmlNodeListGetString(l->doc, attr->children, 1);
+            res = xmlAddIDSafe(attr, value ? value : BAD_CAST "");
+            xmlFree(value);
+        }
+        if (res < 0)
+            goto error;
+    } else {
+        attr->atype = atype;
+    }
+
+    return(attr);
+
+error:
+    l->reader.error = 1;
+    xmlFreeProp(attr);
+    return(NULL);
+}
+
+static xmlNodePtr
+xmlDocBinReadElement(xmlDocBinLoader *l, unsigned type, unsigned line) {
+    xmlNodePtr cur;
+    xmlNsPtr nsDef = NULL, lastNs = NULL, ns;
+    xmlAttrPtr attr, lastAttr = NULL;
+    const xmlChar *name, *prefix, *href;
+    unsigned nbNs, i;
+
+    nbNs = xmlBinReadVarint(&l->reader);
+    for (i = 0; (i < nbNs) && (!l->reader.error); i++) {
+        prefix = xmlDocBinReadName(l);
+        href = xmlDocBinReadName(l);
+        if ((l->reader.error) || (l->nbNsDefs >= l->maxNsDefs))
+            goto error;
+        ns = xmlNewNs(NULL, href, prefix);
+        if (ns == NULL)
+            goto error;
+        xmlDictNsId(l->doc->dict, href, 1);
+        if (lastNs == NULL)
+            nsDef = ns;
+        else
+            lastNs->next = ns;
+        lastNs = ns;
+        l->nsTab[l->nbNsDefs++] = ns;
+    }
 
+    name = xmlDocBinReadName(l);
+    ns = xmlDocBinReadNsRef(l);
+    if ((l->reader.error) || (name == NULL))
+        goto error;
+    cur = xmlNewElem(l->doc, ns, name, NULL);
     if (cur == NULL)
-        return (NULL);
+        goto error;
+    cur->type = type;
+    cur->line = line;
+    cur->nsDef = nsDef;
 
-    switch (cur->type) {
-        case XML_DOCUMENT_NODE:
-        case XML_HTML_DOCUMENT_NODE:
-        case XML_ENTITY_REF_NODE:
+    while (1) {
+        name = xmlDocBinReadName(l);
+        if (name == NULL)
+            break;
+        attr = xmlDocBinReadAttr(l, cur, name);
+        if (attr == NULL)
             break;
+        if (lastAttr == NULL)
+            cur->properties = attr;
+        else
+            lastAttr->next = attr;
+        attr->prev = lastAttr;
+        lastAttr = attr;
+    }
+    if (l->reader.error) {
+        xmlFreeNode(cur);
+        return(NULL);
+    }
 
-        case XML_DOCUMENT_FRAG_NODE:
+    return(cur);
+
+error:
+    l->reader.error = 1;
+    xmlFreeNsList(nsDef);
+    return(NULL);
+}
+
+static xmlNodePtr
+xmlDocBinReadNode(xmlDocBinLoader *l, unsigned type) {
+    xmlNodePtr cur = NULL;
+    xmlEntityPtr ent;
+    const xmlChar *name, *content;
+    unsigned line;
+    int len;
+
+    line = xmlBinReadVarint(&l->reader);
+    if (line > 65535)
+        line = 65535;
+
+    switch (type) {
         case XML_ELEMENT_NODE:
-        case XML_ATTRIBUTE_NODE:
-        case XML_ENTITY_DECL: {
-            xmlNodePtr children = cur->children;
+        case XML_XINCLUDE_START:
+        case XML_XINCLUDE_END:
+            return(xmlDocBinReadElement(l, type, line));
 
-            if (children == NULL)
-                return(xmlStrdup(BAD_CAST ""));
+        case XML_TEXT_NODE: {
+            unsigned flags = xmlBinReadVarint(&l->reader);
 
-            /* Optimization for single text children */
-            if (((children->type == XML_TEXT_NODE) ||
-                 (children->type == XML_CDATA_SECTION_NODE)) &&
-                (children->next == NULL)) {
-                if (children->content == NULL)
-                    return(xmlStrdup(BAD_CAST ""));
-                return(xmlStrdup(children->content));
+            name = (flags & XML_DOC_BIN_NOENC) ? xmlStringTextNoenc :
+                                                 xmlStringText;
+            if (flags & XML_DOC_BIN_INTERN) {
+                content = xmlDocBinReadName(l);
+                if ((l->reader.error) || (content == NULL))
+                    break;
+                cur = xmlDocBinNewNode(l->doc, type, name, NULL, 0);
+                if (cur != NULL)
+                    cur->content = (xmlChar *) content;
+                break;
             }
-
+            content = xmlDocBinReadText(l, &len);
+            if (l->reader.error)
+                return(NULL);
+            cur = xmlDocBinNewNode(l->doc, type, name, content, len);
             break;
         }
 
         case XML_CDATA_SECTION_NODE:
-        case XML_TEXT_NODE:
         case XML_COMMENT_NODE:
+            content = xmlDocBinReadText(l, &len);
+            if (l->reader.error)
+                return(NULL);
+            cur = xmlDocBinNewNode(l->doc, type,
+                    type == XML_COMMENT_NODE ? xmlStringComment : NULL,
+                    content, len);
+            break;
+
         case XML_PI_NODE:
-            if (cur->content != NULL)
-                return(xmlStrdup(cur->content));
-            else
-                return(xmlStrdup(BAD_CAST ""));
+            name = xmlDocBinReadName(l);
+            content = xmlDocBinReadText(l, &len);
+            if ((l->reader.error) || (name == NULL))
+                break;
+            cur = xmlDocBinNewNode(l->doc, type, name, content, len);
+            break;
 
-        case XML_NAMESPACE_DECL:
-	    return(xmlStrdup(((xmlNsPtr) cur)->href));
+        case XML_ENTITY_REF_NODE:
+            name = xmlDocBinReadName(l);
+            if ((l->reader.error) || (name == NULL))
+                break;
+            cur = xmlDocBinNewNode(l->doc, type, name, NULL, 0);
+            if (cur == NULL)
+                break;
+            ent = xmlGetDocEntity(l->doc, name);
+            if (ent != NULL) {
+                cur->content = ent->content;
+                cur->children = (xmlNodePtr) ent;
+                cur->last = (xmlNodePtr) ent;
+            }
+            break;
 
         default:
-            return(NULL);
+            break;
     }
 
-    buf = xmlBufCreate(50);
-    if (buf == NULL)
-        return (NULL);
-    xmlBufGetNodeContent(buf, cur);
-    ret = xmlBufDetach(buf);
-    xmlBufFree(buf);
+    if (cur == NULL)
+        l->reader.error = 1;
+    else
+        cur->line = line;
+    return(cur);
+}
+
+static xmlElementContentPtr
+xmlDocBinReadContent(xmlDocBinLoader *l, int depth) {
+    xmlElementContentPtr ret = NULL, parent = NULL, cur;
+    unsigned type, ocur;
+
+    if (depth > XML_DOC_BIN_MAX_DEPTH) {
+        l->reader.error = 1;
+        return(NULL);
+    }
+
+    while (!l->reader.error) {
+        type = xmlBinReadVarint(&l->reader);
+        if (type == 0)
+            break;
+        ocur = xmlBinReadVarint(&l->reader);
+        if ((type > XML_ELEMENT_CONTENT_OR) ||
+            (ocur < XML_ELEMENT_CONTENT_ONCE) ||
+            (ocur > XML_ELEMENT_CONTENT_PLUS)) {
+            l->reader.error = 1;
+            break;
+        }
+        cur = xmlNewDocElementContent(l->doc, NULL, type);
+        if (cur == NULL) {
+            l->reader.error = 1;
+            break;
+        }
+        cur->ocur = ocur;
+        cur->name = xmlDocBinReadName(l);
+        cur->prefix = xmlDocBinReadName(l);
+        if (parent == NULL) {
+            ret = cur;
+        } else {
+            parent->c2 = cur;
+            cur->parent = parent;
+        }
+        if ((type != XML_ELEMENT_CONTENT_SEQ) &&
+            (type != XML_ELEMENT_CONTENT_OR))
+            break;
+        cur->c1 = xmlDocBinReadContent(l, depth + 1);
+        if (cur->c1 != NULL)
+            cur->c1->parent = cur;
+        parent = cur;
+    }
 
+    if (l->reader.error) {
+        xmlFreeDocElementContent(l->doc, ret);
+        return(NULL);
+    }
     return(ret);
 }
 
 static int
-xmlNodeSetContentInternal(xmlNodePtr cur, const xmlChar *content, int len) {
-    if (cur == NULL) {
-	return(1);
-    }
-    switch (cur->type) {
-        case XML_DOCUMENT_FRAG_NODE:
-        case XML_ELEMENT_NODE:
-        case XML_ATTRIBUTE_NODE: {
-            size_t maxSize = len < 0 ? SIZE_MAX : (size_t) len;
-
-            /*
-             * We shouldn't parse the content as attribute value here,
-             * but the API can't be changed.
-             */
-            if (xmlNodeParseAttValue(cur->doc, (xmlAttr *) cur,
-                                     content, maxSize, NULL) < 0)
+xmlDocBinReadDecl(xmlDocBinLoader *l, xmlDtdPtr dtd, unsigned type) {
+    xmlDocPtr doc = l->doc;
+
+    switch (type) {
+        case XML_ELEMENT_DECL: {
+            xmlElementContentPtr content;
+            const xmlChar *name, *prefix;
+            xmlChar *qname;
+            xmlChar buf[50];
+            unsigned etype;
+            int ret = -1;
+
+            name = xmlDocBinReadName(l);
+            prefix = xmlDocBinReadName(l);
+            etype = xmlBinReadVarint(&l->reader);
+            content = xmlDocBinReadContent(l, 0);
+            if ((l->reader.error) || (name == NULL))
                 return(-1);
-	    break;
+            qname = xmlBuildQName(name, prefix, buf, sizeof(buf));
+            if ((qname != NULL) &&
+                (xmlAddElementDecl(NULL, dtd, qname, etype, content) != NULL))
+                ret = 0;
+            if ((qname != buf) && (qname != name))
+                xmlFree(qname);
+            xmlFreeDocElementContent(doc, content);
+            return(ret);
         }
 
-        case XML_TEXT_NODE:
-        case XML_CDATA_SECTION_NODE:
-        case XML_PI_NODE:
-        case XML_COMMENT_NODE: {
-            xmlChar *copy = NULL;
-
-	    if (content != NULL) {
-                if (len < 0)
-                    copy = xmlStrdup(content);
+        case XML_ATTRIBUTE_DECL: {
+            xmlEnumerationPtr tree = NULL, last = NULL, e;
+            const xmlChar *elem, *name, *prefix;
+            xmlChar *defaultValue;
+            unsigned atype, def;
+            int ret = -1;
+
+            elem = xmlDocBinReadName(l);
+            name = xmlDocBinReadName(l);
+            prefix = xmlDocBinReadName(l);
+            atype = xmlBinReadVarint(&l->reader);
+            def = xmlBinReadVarint(&l->reader);
+            defaultValue = xmlDocBinReadStrdup(l);
+            while (!l->reader.error) {
+                const xmlChar *value = xmlDocBinReadName(l);
+
+                if (value == NULL)
+                    break;
+                e = xmlCreateEnumeration(value);
+                if (e == NULL) {
+                    l->reader.error = 1;
+                    break;
+                }
+                if (last == NULL)
+                    tree = e;
                 else
-		    copy = xmlStrndup(content, len);
-                if (copy == NULL)
-                    return(-1);
-	    }
+                    last->next = e;
+                last = e;
+            }
+            if ((l->reader.error) || (elem == NULL) || (name == NULL)) {
+                xmlFreeEnumeration(tree);
+            } else if (xmlAddAttributeDecl(NULL, dtd, elem, name, prefix,
+                                           atype, def, defaultValue,
+                                           tree) != NULL) {
+                ret = 0;
+            }
+            xmlFree(defaultValue);
+            return(ret);
+        }
 
-            xmlTextSetContent(cur, copy);
-	    break;
+        case XML_ENTITY_DECL: {
+            xmlEntityPtr ent = NULL;
+            const xmlChar *name;
+            xmlChar *publicId, *systemId, *content, *orig, *URI;
+            unsigned etype, flags;
+
+            name = xmlDocBinReadName(l);
+            etype = xmlBinReadVarint(&l->reader);
+            publicId = xmlDocBinReadStrdup(l);
+            systemId = xmlDocBinReadStrdup(l);
+            content = xmlDocBinReadStrdup(l);
+            orig = xmlDocBinReadStrdup(l);
+            URI = xmlDocBinReadStrdup(l);
+            flags = xmlBinReadVarint(&l->reader);
+            if ((!l->reader.error) &&
+                (xmlAddEntity(doc, 0, name, etype, publicId, systemId,
+                              content, &ent) == XML_ERR_OK)) {
+                ent->orig = orig;
+                ent->URI = URI;
+                ent->flags = flags &
+                    (XML_ENT_PARSED | XML_ENT_CHECKED | XML_ENT_VALIDATED);
+            } else {
+                xmlFree(orig);
+                xmlFree(URI);
+            }
+            xmlFree(publicId);
+            xmlFree(systemId);
+            xmlFree(content);
+            if (ent == NULL)
+                return(-1);
+            return(xmlDocBinReadList(l, (xmlNodePtr) ent));
+        }
+
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE: {
+            xmlNodePtr cur = xmlDocBinReadNode(l, type);
+
+            if (cur == NULL)
+                return(-1);
+            xmlDocBinAppend((xmlNodePtr) dtd, cur);
+            return(0);
         }
 
         default:
+            return(-1);
+    }
+}
+
+static int
+xmlDocBinReadDtd(xmlDocBinLoader *l) {
+    xmlDtdPtr dtd = NULL;
+    xmlChar *name, *publicId, *systemId;
+    unsigned type, n, i;
+
+    xmlBinReadVarint(&l->reader);
+    name = xmlDocBinReadStrdup(l);
+    publicId = xmlDocBinReadStrdup(l);
+    systemId = xmlDocBinReadStrdup(l);
+    if ((!l->reader.error) && (l->doc->intSubset == NULL))
+        dtd = xmlCreateIntSubset(l->doc, name, publicId, systemId);
+    xmlFree(name);
+    xmlFree(publicId);
+    xmlFree(systemId);
+    if (dtd == NULL)
+        return(-1);
+
+    while (!l->reader.error) {
+        type = xmlBinReadVarint(&l->reader);
+        if (type == 0)
             break;
+        if (xmlDocBinReadDecl(l, dtd, type) < 0)
+            return(-1);
     }
 
-    return(0);
+    n = xmlDocBinReadCount(l, 3);
+    for (i = 0; (i < n) && (!l->reader.error); i++) {
+        const xmlChar *nota;
+
+        nota = xmlDocBinReadName(l);
+        publicId = xmlDocBinReadStrdup(l);
+        systemId = xmlDocBinReadStrdup(l);
+        if ((!l->reader.error) &&
+            (xmlAddNotationDecl(NULL, dtd, nota, publicId,
+                                systemId) == NULL))
+            l->reader.error = 1;
+        xmlFree(publicId);
+        xmlFree(systemId);
+    }
+
+    return(l->reader.error ? -1 : 0);
 }
 
-/**
- * Replace the text content of a node.
- *
- * Sets the raw text content of text, CDATA, comment or PI nodes.
- *
- * For element and attribute nodes, removes all children and
- * replaces them by parsing `content` which is expected to be a
- * valid XML attribute value possibly containing character and
- * entity references. Syntax errors and references to undeclared
- * entities are ignored silently. Unfortunately, there isn't an
- * API to pass raw content directly. An inefficient work-around
- * is to escape the content with #xmlEncodeSpecialChars before
- * passing it. A better trick is clearing the old content
- * with `xmlNodeSetContent(node, NULL)` first and then calling
- * `xmlNodeAddContent(node, content)`. Unlike this function,
- * #xmlNodeAddContent accepts raw text.
- *
- * @param cur  the node being modified
- * @param content  the new value of the content
- * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
+/*
+ * Read the children of a document or entity and their descendants.
  */
-int
-xmlNodeSetContent(xmlNode *cur, const xmlChar *content) {
-    return(xmlNodeSetContentInternal(cur, content, -1));
+static int
+xmlDocBinReadList(xmlDocBinLoader *l, xmlNodePtr top) {
+    xmlNodePtr parent = top, cur;
+    unsigned type;
+
+    while (!l->reader.error) {
+        type = xmlBinReadVarint(&l->reader);
+        if (l->reader.error)
+            break;
+        if (type == 0) {
+            if (parent == top)
+                return(0);
+            parent = parent->parent;
+            continue;
+        }
+
+        if (type == XML_DTD_NODE) {
+            if ((parent != (xmlNodePtr) l->doc) ||
+                (xmlDocBinReadDtd(l) < 0))
+                break;
+            continue;
+        }
+
+        cur = xmlDocBinReadNode(l, type);
+        if (cur == NULL)
+            break;
+        xmlDocBinAppend(parent, cur);
+        if ((type == XML_ELEMENT_NODE) ||
+            (type == XML_XINCLUDE_START) ||
+            (type == XML_XINCLUDE_END))
+            parent = cur;
+    }
+
+    l->reader.error = 1;
+    return(-1);
 }
 
 /**
- * See #xmlNodeSetContent.
+ * Load a document serialized by #xmlDocSaveBinaryMemory. Nothing
+ * has to be decoded, unescaped or checked for well-formedness, so
+ * this is much faster than parsing the serialized document. Names
+ * are stored in a new dictionary of the document.
  *
- * @param cur  the node being modified
- * @param content  the new value of the content
- * @param len  the size of `content`
- * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
+ * The buffer can be freed or unmapped once the function returns.
+ * The input must have been written by the same version of the
+ * library. It's checked for truncation and bad references but not
+ * meant to be untrusted.
+ *
+ * @since 2.16.0
+ * @param mem  the serialized document
+ * @param size  the size of the buffer
+ * @returns the document or NULL in case of error.
  */
-int
-xmlNodeSetContentLen(xmlNode *cur, const xmlChar *content, int len) {
-    return(xmlNodeSetContentInternal(cur, content, len));
-}
+xmlDoc *
+xmlDocLoadBinaryMemory(const char *mem, int size) {
+    xmlDocBinLoader l;
+    xmlDocPtr doc;
+    const xmlChar *str;
+    xmlNsPtr ns;
+    unsigned n, i;
+    int type, len;
 
-/**
- * Append the extra substring to the node content.
- *
- * NOTE: In contrast to #xmlNodeSetContentLen, `content` is supposed
- * to be raw text, so unescaped XML special chars are allowed, entity
- * references are not supported.
- *
- * This doesn't work on attributes before version 2.15.
- *
- * @param cur  the node being modified
- * @param content  extra content
- * @param len  the size of `content`
- * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
- */
-int
-xmlNodeAddContentLen(xmlNode *cur, const xmlChar *content, int len) {
-    if (cur == NULL)
-	return(1);
-    if ((content == NULL) || (len <= 0))
-        return(0);
+    if ((mem == NULL) || (size < 8) ||
+        (memcmp(mem, XML_DOC_BIN_MAGIC, 4) != 0))
+        return(NULL);
 
-    switch (cur->type) {
-        case XML_DOCUMENT_FRAG_NODE:
-        case XML_ELEMENT_NODE:
-        case XML_ATTRIBUTE_NODE: {
-	    xmlNodePtr newNode, tmp;
+    memset(&l, 0, sizeof(l));
+    l.reader.cur = (const unsigned char *) mem + 4;
+    l.reader.end = (const unsigned char *) mem + size;
+    if (xmlBinReadInt(&l.reader) != XML_DOC_BIN_VERSION)
+        return(NULL);
+    type = xmlBinReadInt(&l.reader);
+    if ((type != XML_DOCUMENT_NODE) && (type != XML_HTML_DOCUMENT_NODE))
+        return(NULL);
 
-	    newNode = xmlNewDocTextLen(cur->doc, content, len);
-	    if (newNode == NULL)
-                return(-1);
-            tmp = xmlAddChild(cur, newNode);
-            if (tmp == NULL) {
-                xmlFreeNode(newNode);
-                return(-1);
-            }
-	    break;
-	}
-	    break;
-        case XML_TEXT_NODE:
-        case XML_CDATA_SECTION_NODE:
-        case XML_PI_NODE:
-        case XML_COMMENT_NODE:
-            return(xmlTextAddContent(cur, content, len));
-        default:
-            break;
+    doc = xmlNewDoc(NULL);
+    if (doc == NULL)
+        return(NULL);
+    l.doc = doc;
+    doc->type = type;
+    doc->dict = xmlDictCreate();
+    if (doc->dict == NULL)
+        goto error;
+    doc->standalone = xmlBinReadInt(&l.reader);
+    doc->properties = xmlBinReadInt(&l.reader) & ~XML_DOC_FROZEN;
+    doc->parseFlags = xmlBinReadInt(&l.reader);
+    xmlFree(doc->version);
+    doc->version = xmlBinReadStrdup(&l.reader);
+    doc->encoding = xmlBinReadStrdup(&l.reader);
+    doc->URL = xmlBinReadStrdup(&l.reader);
+
+    n = xmlDocBinReadCount(&l, 1);
+    l.strTab = xmlMalloc((n + 1) * sizeof(l.strTab[0]));
+    if (l.strTab == NULL)
+        goto error;
+    for (i = 0; (i < n) && (!l.reader.error); i++) {
+        str = xmlDocBinReadText(&l, &len);
+        if (str == NULL)
+            goto error;
+        str = xmlDictLookup(doc->dict, str, len);
+        if (str == NULL)
+            goto error;
+        l.strTab[l.nbStrings++] = str;
     }
 
-    return(0);
+    n = xmlDocBinReadCount(&l, 2);
+    l.foreign = xmlMalloc((n + 1) * sizeof(l.foreign[0]));
+    if (l.foreign == NULL)
+        goto error;
+    for (i = 0; (i < n) && (!l.reader.error); i++) {
+        const xmlChar *prefix = xmlDocBinReadName(&l);
+        const xmlChar *href = xmlDocBinReadName(&l);
+
+        /* The XML namespace must be the head of the oldNs list */
+        if (xmlTreeEnsureXMLDecl(doc) == NULL)
+            goto error;
+        if ((xmlStrEqual(prefix, BAD_CAST "xml")) &&
+            (xmlStrEqual(href, XML_XML_NAMESPACE))) {
+            ns = doc->oldNs;
+        } else {
+            xmlNsPtr last = doc->oldNs;
+
+            ns = xmlNewNs(NULL, href, prefix);
+            if (ns == NULL)
+                goto error;
+            xmlDictNsId(doc->dict, href, 1);
+            while (last->next != NULL)
+                last = last->next;
+            last->next = ns;
+        }
+        l.foreign[l.nbForeign++] = ns;
+    }
+
+    n = xmlDocBinReadCount(&l, 2);
+    l.nsTab = xmlMalloc((n + 1) * sizeof(l.nsTab[0]));
+    if (l.nsTab == NULL)
+        goto error;
+    l.maxNsDefs = n;
+
+    if ((l.reader.error) ||
+        (xmlDocBinReadList(&l, (xmlNodePtr) doc) < 0) ||
+        (l.reader.cur != l.reader.end))
+        goto error;
+
+    xmlFree(l.strTab);
+    xmlFree(l.foreign);
+    xmlFree(l.nsTab);
+    return(doc);
+
+error:
+    xmlFree(l.strTab);
+    xmlFree(l.foreign);
+    xmlFree(l.nsTab);
+    xmlFreeDoc(doc);
+    return(NULL);
 }
 
 /**
- * Append the extra substring to the node content.
- *
- * NOTE: In contrast to #xmlNodeSetContent, `content` is supposed
- * to be raw text, so unescaped XML special chars are allowed, entity
- * references are not supported.
- *
- * This doesn't work on attributes before version 2.15.
+ * Load a document from a file written by #xmlDocSaveBinary. Regular
+ * files are mapped into memory.
  *
- * @param cur  the node being modified
- * @param content  extra content
- * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
+ * @since 2.16.0
+ * @param filename  the file name or URI
+ * @returns the document or NULL in case of error.
  */
-int
-xmlNodeAddContent(xmlNode *cur, const xmlChar *content) {
-    return(xmlNodeAddContentLen(cur, content, xmlStrlen(content)));
+xmlDoc *
+xmlDocLoadBinary(const char *filename) {
+    xmlParserInputBufferPtr in;
+    xmlDocPtr ret = NULL;
+    int res;
+
+    if ((filename == NULL) ||
+        (xmlParserInputBufferCreateUrl(filename, XML_CHAR_ENCODING_NONE,
+                                       XML_INPUT_MMAP, &in) != XML_ERR_OK))
+        return(NULL);
+    do {
+        res = xmlParserInputBufferGrow(in, 65536);
+    } while (res > 0);
+    if ((res == 0) && (xmlBufUse(in->buffer) <= INT_MAX))
+        ret = xmlDocLoadBinaryMemory((const char *) xmlBufContent(in->buffer),
+                                     xmlBufUse(in->buffer));
+    xmlFreeParserInputBuffer(in);
+    return(ret);
 }
 
-/**
- * Merge the second text node into the first. If `first` is NULL,
- * `second` is returned. Otherwise, the second node is unlinked and
- * freed.
+/************************************************************************
+ *									*
+ *		Document images						*
+ *									*
+ ************************************************************************/
+
+/*
+ * An image is a snapshot (see above) stored in a file together with
+ * the document node, the namespaces and all names, so that it can be
+ * mapped into memory and used without parsing or allocation. The
+ * file contains
  *
- * @param first  the first text node
- * @param second  the second text node being merged
- * @returns the first text node augmented or NULL in case of error.
+ * - the header,
+ * - the document node,
+ * - the nodes and text of the snapshot image,
+ * - the namespaces,
+ * - the names, prefixes and namespace URIs.
+ *
+ * Pointers are stored as they are when the file is mapped at the base
+ * address in the header. If the file can't be mapped there, every
+ * pointer in the records is relocated, which makes the pages private
+ * to the process.
  */
-xmlNode *
-xmlTextMerge(xmlNode *first, xmlNode *second) {
-    if (first == NULL)
-        return(second);
-    if (second == NULL)
-        return(first);
 
-    if ((first->type != XML_TEXT_NODE) ||
-        (second->type != XML_TEXT_NODE) ||
-        (first == second) ||
-        (first->name != second->name))
-	return(NULL);
+#define XML_DOC_IMAGE_MAGIC "LXDI"
+#define XML_DOC_IMAGE_VERSION 1
 
-    if (xmlTextAddContent(first, second->content, -1) < 0)
+typedef struct {
+    char magic[4];
+    unsigned int version;
+    /* Layout of the records, images only load on the same platform */
+    unsigned short ptrSize;
+    unsigned short docSize;
+    unsigned short nodeSize;
+    unsigned short attrSize;
+    unsigned short nsSize;
+    unsigned short reserved;
+    unsigned long long base;      /* preferred address */
+    unsigned long long size;      /* size of the file */
+    unsigned long long nodesSize; /* size of the node records */
+    unsigned long long snapSize;  /* size of nodes and text */
+    unsigned long long nbNs;
+} xmlDocImageHeader;
+
+#define XML_DOC_IMAGE_ALIGN(size) (((size) + 15) & ~((size_t) 15))
+
+/* Offsets of the document node and the nodes */
+#define XML_DOC_IMAGE_DOC XML_DOC_IMAGE_ALIGN(sizeof(xmlDocImageHeader))
+#define XML_DOC_IMAGE_NODES \
+    (XML_DOC_IMAGE_DOC + XML_DOC_IMAGE_ALIGN(sizeof(xmlDoc)))
+#define XML_DOC_IMAGE_NS_SIZE XML_SNAPSHOT_ALIGN(sizeof(xmlNs))
+
+/*
+ * Images are spread over 256 slots of 64 GB in a part of the address
+ * space which is normally unused on 64-bit systems, so that a process
+ * can usually map several images without relocation.
+ */
+#define XML_DOC_IMAGE_AREA 0x500000000000ULL
+#define XML_DOC_IMAGE_SLOT (64ULL << 30)
+
+#ifdef LIBXML_OUTPUT_ENABLED
+typedef struct {
+    char *image;                /* the file up to the strings */
+    unsigned long long base;
+    const char *snapImage;
+    size_t snapSize;
+    size_t nsOffset;
+    size_t strOffset;
+    xmlBufPtr strings;
+    xmlHashTablePtr strTab;     /* offsets of strings plus one */
+    int error;
+} xmlDocImageWriter;
+
+static void *
+xmlDocImageAddr(xmlDocImageWriter *w, size_t offset) {
+    return(XML_INT_TO_PTR(w->base + offset));
+}
+
+static void *
+xmlDocImageNode(xmlDocImageWriter *w, const void *node) {
+    if (node == NULL)
         return(NULL);
+    return(xmlDocImageAddr(w, XML_DOC_IMAGE_NODES +
+                              ((const char *) node - w->snapImage)));
+}
 
-    xmlUnlinkNodeInternal(second);
-    xmlFreeNode(second);
-    return(first);
+static xmlNsPtr
+xmlDocImageNs(xmlDocImageWriter *w, const xmlNs *ns) {
+    /* Namespaces of the snapshot are indices starting from 1 */
+    if (ns == NULL)
+        return(NULL);
+    return(xmlDocImageAddr(w, w->nsOffset +
+                              (XML_PTR_TO_INT(ns) - 1) *
+                              XML_DOC_IMAGE_NS_SIZE));
+}
+
+static xmlChar *
+xmlDocImageString(xmlDocImageWriter *w, const xmlChar *str) {
+    void *offset;
+
+    if (str == NULL)
+        return(NULL);
+
+    offset = xmlHashLookup(w->strTab, str);
+    if (offset == NULL) {
+        offset = XML_INT_TO_PTR(xmlBufUse(w->strings) + 1);
+        if ((xmlBufAdd(w->strings, str, strlen((const char *) str) + 1) < 0) ||
+            (xmlHashAdd(w->strTab, str, offset) < 0)) {
+            w->error = 1;
+            return(NULL);
+        }
+    }
+    return(xmlDocImageAddr(w, w->strOffset + XML_PTR_TO_INT(offset) - 1));
 }
 
 /**
- * Find all in-scope namespaces of a node. `out` returns a NULL
- * terminated array of namespace pointers that must be freed by
- * the caller.
+ * Convert the pointers of the snapshot's nodes and namespaces to
+ * addresses in the image.
  *
- * @since 2.13.0
- *
- * @param doc  the document
- * @param node  the current node
- * @param out  the returned namespace array
- * @returns 0 on success, 1 if no namespaces were found, -1 if a
- * memory allocation failed.
+ * @param w  the writer
+ * @param snap  the snapshot
  */
-int
-xmlGetNsListSafe(const xmlDoc *doc ATTRIBUTE_UNUSED, const xmlNode *node,
-                 xmlNs ***out)
-{
-    xmlNsPtr cur;
-    xmlNsPtr *namespaces = NULL;
-    int nbns = 0;
-    int maxns = 0;
+static void
+xmlDocImageFill(xmlDocImageWriter *w, xmlDocSnapshotPtr snap) {
+    xmlDocPtr docAddr = xmlDocImageAddr(w, XML_DOC_IMAGE_DOC);
+    xmlDocPtr doc = (xmlDocPtr) (w->image + XML_DOC_IMAGE_DOC);
+    const char *start = w->snapImage;
+    const char *end = start + w->snapSize;
+    size_t offset = 0;
     int i;
 
-    if (out == NULL)
-        return(1);
-    *out = NULL;
-    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
-        return(1);
+    while (offset < snap->nodesSize) {
+        xmlNodePtr node = (xmlNodePtr) (w->image + XML_DOC_IMAGE_NODES +
+                                        offset);
 
-    while (node != NULL) {
-        if (node->type == XML_ELEMENT_NODE) {
-            cur = node->nsDef;
-            while (cur != NULL) {
-                for (i = 0; i < nbns; i++) {
-                    if ((cur->prefix == namespaces[i]->prefix) ||
-                        (xmlStrEqual(cur->prefix, namespaces[i]->prefix)))
-                        break;
-                }
-                if (i >= nbns) {
-                    if (nbns >= maxns) {
-                        xmlNsPtr *tmp;
-                        int newSize;
+        node->doc = docAddr;
+        if (node->parent == NULL)
+            node->parent = (xmlNodePtr) docAddr;
+        else
+            node->parent = xmlDocImageNode(w, node->parent);
+        node->next = xmlDocImageNode(w, node->next);
+        node->prev = xmlDocImageNode(w, node->prev);
+        node->ns = xmlDocImageNs(w, node->ns);
+        node->name = xmlDocImageString(w, node->name);
 
-                        newSize = xmlGrowCapacity(maxns, sizeof(tmp[0]),
-                                                  10, XML_MAX_ITEMS);
-                        if (newSize < 0) {
-                            xmlFree(namespaces);
-                            return(-1);
-                        }
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-                        if (newSize < 2)
-                            newSize = 2;
-#endif
-                        tmp = xmlRealloc(namespaces,
-                                         (newSize + 1) * sizeof(tmp[0]));
-                        if (tmp == NULL) {
-                            xmlFree(namespaces);
-                            return(-1);
-                        }
-                        namespaces = tmp;
-                        maxns = newSize;
-                    }
-                    namespaces[nbns++] = cur;
-                    namespaces[nbns] = NULL;
-                }
+        if (node->type == XML_ATTRIBUTE_NODE) {
+            xmlAttrPtr attr = (xmlAttrPtr) node;
 
-                cur = cur->next;
+            attr->children = xmlDocImageNode(w, attr->children);
+            attr->last = xmlDocImageNode(w, attr->last);
+            attr->psvi = NULL;
+            offset += XML_SNAPSHOT_ATTR_SIZE;
+        } else {
+            if (node->type == XML_ENTITY_REF_NODE) {
+                /* Entities aren't part of the image */
+                node->children = NULL;
+                node->last = NULL;
+            } else {
+                node->children = xmlDocImageNode(w, node->children);
+                node->last = xmlDocImageNode(w, node->last);
             }
+            node->properties = xmlDocImageNode(w, node->properties);
+            node->nsDef = xmlDocImageNs(w, node->nsDef);
+            if (((const char *) node->content >= start) &&
+                ((const char *) node->content < end))
+                node->content = xmlDocImageNode(w, node->content);
+            else
+                node->content = xmlDocImageString(w, node->content);
+            /* Only text nodes store line numbers there */
+            if (node->type != XML_TEXT_NODE)
+                node->psvi = NULL;
+            offset += XML_SNAPSHOT_NODE_SIZE;
         }
-        node = node->parent;
     }
 
-    *out = namespaces;
-    return((namespaces == NULL) ? 1 : 0);
+    for (i = 0; i < snap->nbNs; i++) {
+        xmlNsPtr ns = (xmlNsPtr) (w->image + w->nsOffset +
+                                  i * XML_DOC_IMAGE_NS_SIZE);
+
+        ns->next = xmlDocImageNs(w, snap->nsTab[i].next);
+        ns->type = snap->nsTab[i].type;
+        ns->href = xmlDocImageString(w, snap->nsTab[i].href);
+        ns->prefix = xmlDocImageString(w, snap->nsTab[i].prefix);
+        ns->_private = NULL;
+        ns->context = docAddr;
+    }
+
+    doc->type = snap->doc->type;
+    doc->children = xmlDocImageNode(w, snap->children);
+    doc->last = xmlDocImageNode(w, snap->last);
+    doc->doc = docAddr;
+    doc->compression = snap->doc->compression;
+    doc->standalone = snap->doc->standalone;
+    if (snap->nbOldNs > 0)
+        doc->oldNs = xmlDocImageNs(w, XML_INT_TO_PTR(1));
+    doc->version = xmlDocImageString(w, snap->doc->version);
+    doc->encoding = xmlDocImageString(w, snap->doc->encoding);
+    doc->URL = xmlDocImageString(w, snap->doc->URL);
+    doc->charset = snap->doc->charset;
+    doc->parseFlags = snap->doc->parseFlags;
+    /* Evaluation mustn't write to the document */
+    doc->properties = (snap->doc->properties & 0xFF) |
+                      XML_DOC_FROZEN | XML_DOC_IMAGE;
+}
+
+static void
+xmlDocImageWrite(xmlOutputBufferPtr out, const char *mem, size_t size) {
+    while (size > 0) {
+        int len = (size > INT_MAX / 2) ? INT_MAX / 2 : (int) size;
+
+        if (xmlOutputBufferWrite(out, len, mem) < 0)
+            return;
+        mem += len;
+        size -= len;
+    }
 }
 
 /**
- * Find all in-scope namespaces of a node.
+ * Save a document as an image which can be mapped into memory with
+ * #xmlDocMapImage. All processes mapping the same image share its
+ * memory and don't have to parse the document.
  *
- * Use #xmlGetNsListSafe for better error reporting.
+ * The image contains the same nodes as a snapshot of the document,
+ * see #xmlNewDocSnapshot, but no DTD. Entity references have no
+ * children and no ID attributes are registered. Images depend on
+ * the platform and the version of the library.
+ *
+ * @since 2.16.0
  *
  * @param doc  the document
- * @param node  the current node
- * @returns a NULL terminated array of namespace pointers that must
- * be freed by the caller or NULL if no namespaces were found or
- * a memory allocation failed.
+ * @param filename  the file name or URI
+ * @returns 0 on success, -1 if the document contains unsupported
+ * nodes or in case of error.
  */
-xmlNs **
-xmlGetNsList(const xmlDoc *doc, const xmlNode *node)
-{
-    xmlNsPtr *ret;
+int
+xmlDocSaveImage(xmlDoc *doc, const char *filename) {
+    xmlDocImageWriter w;
+    xmlDocImageHeader *header;
+    xmlDocSnapshotPtr snap;
+    xmlOutputBufferPtr out;
+    size_t key;
+    int ret = -1;
+
+    if (filename == NULL)
+        return(-1);
+    snap = xmlNewDocSnapshot(doc);
+    if (snap == NULL)
+        return(-1);
 
-    xmlGetNsListSafe(doc, node, &ret);
-    return(ret);
-}
+    memset(&w, 0, sizeof(w));
+    w.snapImage = snap->image;
+    w.snapSize = snap->size;
+    w.nsOffset = XML_DOC_IMAGE_NODES + XML_DOC_IMAGE_ALIGN(snap->size);
+    w.strOffset = w.nsOffset + snap->nbNs * XML_DOC_IMAGE_NS_SIZE;
+    if (sizeof(void *) >= 8) {
+        key = (snap->size ^ snap->nbNs) * 2654435761u;
+        w.base = XML_DOC_IMAGE_AREA +
+                 ((key >> 16) & 0xFF) * XML_DOC_IMAGE_SLOT;
+    }
+    w.image = xmlMalloc(w.strOffset);
+    w.strings = xmlBufCreate(4096);
+    w.strTab = xmlHashCreate(0);
+    if ((w.image == NULL) || (w.strings == NULL) || (w.strTab == NULL))
+        goto done;
+    memset(w.image, 0, w.strOffset);
+    memcpy(w.image + XML_DOC_IMAGE_NODES, snap->image, snap->size);
 
-static xmlNsPtr
-xmlNewXmlNs(void) {
-    xmlNsPtr ns;
+    xmlDocImageFill(&w, snap);
+    if ((w.error) || (xmlBufContent(w.strings) == NULL))
+        goto done;
 
-    ns = (xmlNsPtr) xmlMalloc(sizeof(xmlNs));
-    if (ns == NULL)
-        return(NULL);
-    memset(ns, 0, sizeof(xmlNs));
-    ns->type = XML_LOCAL_NAMESPACE;
-    ns->href = xmlStrdup(XML_XML_NAMESPACE);
-    if (ns->href == NULL) {
-        xmlFreeNs(ns);
-        return(NULL);
-    }
-    ns->prefix = xmlStrdup(BAD_CAST "xml");
-    if (ns->prefix == NULL) {
-        xmlFreeNs(ns);
-        return(NULL);
-    }
+    header = (xmlDocImageHeader *) w.image;
+    memcpy(header->magic, XML_DOC_IMAGE_MAGIC, 4);
+    header->version = XML_DOC_IMAGE_VERSION;
+    header->ptrSize = sizeof(void *);
+    header->docSize = sizeof(xmlDoc);
+    header->nodeSize = sizeof(xmlNode);
+    header->attrSize = sizeof(xmlAttr);
+    header->nsSize = sizeof(xmlNs);
+    header->base = w.base;
+    header->size = w.strOffset + xmlBufUse(w.strings);
+    header->nodesSize = snap->nodesSize;
+    header->snapSize = snap->size;
+    header->nbNs = snap->nbNs;
+
+    out = xmlOutputBufferCreateFilename(filename, NULL, 0);
+    if (out == NULL)
+        goto done;
+    xmlDocImageWrite(out, w.image, w.strOffset);
+    xmlDocImageWrite(out, (const char *) xmlBufContent(w.strings),
+                     xmlBufUse(w.strings));
+    if (xmlOutputBufferClose(out) >= 0)
+        ret = 0;
 
-    return(ns);
+done:
+    xmlHashFree(w.strTab, NULL);
+    xmlBufFree(w.strings);
+    xmlFree(w.image);
+    xmlFreeDocSnapshot(snap);
+    return(ret);
 }
+#endif /* LIBXML_OUTPUT_ENABLED */
 
-/*
-* xmlTreeEnsureXMLDecl:
-* @doc: the doc
-*
-* Ensures that there is an XML namespace declaration on the doc.
-*
-* Returns the XML ns-struct or NULL if a memory allocation failed.
-*/
-static xmlNsPtr
-xmlTreeEnsureXMLDecl(xmlDocPtr doc)
-{
-    xmlNsPtr ns;
-
-    ns = doc->oldNs;
-    if (ns != NULL)
-	return (ns);
-
-    ns = xmlNewXmlNs();
-    doc->oldNs = ns;
+static int
+xmlDocImageCheck(const char *map, size_t size, xmlDocImageHeader *header) {
+    size_t nsOffset;
 
-    return(ns);
+    if (size < XML_DOC_IMAGE_NODES)
+        return(-1);
+    memcpy(header, map, sizeof(*header));
+    if ((memcmp(header->magic, XML_DOC_IMAGE_MAGIC, 4) != 0) ||
+        (header->version != XML_DOC_IMAGE_VERSION) ||
+        (header->ptrSize != sizeof(void *)) ||
+        (header->docSize != sizeof(xmlDoc)) ||
+        (header->nodeSize != sizeof(xmlNode)) ||
+        (header->attrSize != sizeof(xmlAttr)) ||
+        (header->nsSize != sizeof(xmlNs)) ||
+        (header->size != size) ||
+        (header->snapSize > size - XML_DOC_IMAGE_NODES) ||
+        (header->nodesSize > header->snapSize))
+        return(-1);
+    nsOffset = XML_DOC_IMAGE_NODES + XML_DOC_IMAGE_ALIGN(header->snapSize);
+    if ((nsOffset > size) ||
+        (header->nbNs > (size - nsOffset) / XML_DOC_IMAGE_NS_SIZE))
+        return(-1);
+    return(0);
 }
 
 /**
- * Search for a namespace with `prefix` in scope of `node`.
+ * Relocate an image which isn't mapped at its base address.
  *
- * @param node  a node
- * @param prefix  a namespace prefix
- * @param out  pointer to resulting namespace
- * @returns 0 on success, -1 if a memory allocation failed, 1 on
- * other errors.
+ * @param map  the image
+ * @param header  the header of the image
+ * @returns 0 on success, -1 if the image is invalid.
  */
-int
-xmlSearchNsSafe(xmlNode *node, const xmlChar *prefix,
-                xmlNs **out) {
-    xmlNsPtr cur;
-    xmlDocPtr doc;
-    xmlNodePtr orig = node;
-    xmlNodePtr parent;
-
-    if (out == NULL)
-        return(1);
-    *out = NULL;
-    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
-        return(1);
-
-    doc = node->doc;
-
-    if ((doc != NULL) && (IS_STR_XML(prefix))) {
-        cur = xmlTreeEnsureXMLDecl(doc);
-        if (cur == NULL)
+static int
+xmlDocImageRelocate(char *map, const xmlDocImageHeader *header) {
+    xmlDocPtr doc = (xmlDocPtr) (map + XML_DOC_IMAGE_DOC);
+    XML_INTPTR_T delta;
+    size_t offset = 0;
+    size_t nsOffset;
+    unsigned long long i;
+
+    delta = XML_PTR_TO_INT(map) - (XML_INTPTR_T) header->base;
+
+    doc->children = xmlSnapshotReloc(doc->children, delta);
+    doc->last = xmlSnapshotReloc(doc->last, delta);
+    doc->doc = xmlSnapshotReloc(doc->doc, delta);
+    doc->oldNs = xmlSnapshotReloc(doc->oldNs, delta);
+    doc->version = xmlSnapshotReloc(doc->version, delta);
+    doc->encoding = xmlSnapshotReloc(doc->encoding, delta);
+    doc->URL = xmlSnapshotReloc(doc->URL, delta);
+
+    while (offset < header->nodesSize) {
+        xmlNodePtr node = (xmlNodePtr) (map + XML_DOC_IMAGE_NODES + offset);
+
+        size_t recSize;
+
+        switch (node->type) {
+            case XML_ATTRIBUTE_NODE:
+                recSize = XML_SNAPSHOT_ATTR_SIZE;
+                break;
+            case XML_ELEMENT_NODE:
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+            case XML_ENTITY_REF_NODE:
+            case XML_PI_NODE:
+            case XML_COMMENT_NODE:
+            case XML_XINCLUDE_START:
+            case XML_XINCLUDE_END:
+                recSize = XML_SNAPSHOT_NODE_SIZE;
+                break;
+            default:
+                return(-1);
+        }
+        if (recSize > header->nodesSize - offset)
             return(-1);
-        *out = cur;
-        return(0);
+        offset += recSize;
+
+        if (node->type != XML_ATTRIBUTE_NODE) {
+            node->content = xmlSnapshotReloc(node->content, delta);
+            node->properties = xmlSnapshotReloc(node->properties, delta);
+            node->nsDef = xmlSnapshotReloc(node->nsDef, delta);
+        }
+        /* Fields shared by nodes and attributes */
+        node->name = xmlSnapshotReloc((void *) node->name, delta);
+        node->children = xmlSnapshotReloc(node->children, delta);
+        node->last = xmlSnapshotReloc(node->last, delta);
+        node->parent = xmlSnapshotReloc(node->parent, delta);
+        node->next = xmlSnapshotReloc(node->next, delta);
+        node->prev = xmlSnapshotReloc(node->prev, delta);
+        node->doc = xmlSnapshotReloc(node->doc, delta);
+        node->ns = xmlSnapshotReloc(node->ns, delta);
     }
 
-    while (node->type != XML_ELEMENT_NODE) {
-        node = node->parent;
-        if (node == NULL)
-            return(0);
+    nsOffset = XML_DOC_IMAGE_NODES + XML_DOC_IMAGE_ALIGN(header->snapSize);
+    for (i = 0; i < header->nbNs; i++) {
+        xmlNsPtr ns = (xmlNsPtr) (map + nsOffset + i * XML_DOC_IMAGE_NS_SIZE);
+
+        ns->next = xmlSnapshotReloc(ns->next, delta);
+        ns->href = xmlSnapshotReloc((void *) ns->href, delta);
+        ns->prefix = xmlSnapshotReloc((void *) ns->prefix, delta);
+        ns->context = xmlSnapshotReloc(ns->context, delta);
     }
 
-    parent = node;
+    return(0);
+}
 
-    while ((node != NULL) && (node->type == XML_ELEMENT_NODE)) {
-        cur = node->nsDef;
-        while (cur != NULL) {
-            if ((xmlStrEqual(cur->prefix, prefix)) &&
-                (cur->href != NULL)) {
-                *out = cur;
-                return(0);
-            }
-            cur = cur->next;
-        }
-        if (orig != node) {
-            cur = node->ns;
-            if ((cur != NULL) &&
-                (xmlStrEqual(cur->prefix, prefix)) &&
-                (cur->href != NULL)) {
-                *out = cur;
-                return(0);
-            }
-        }
+/**
+ * Map a document image written by #xmlDocSaveImage into memory.
+ *
+ * If the image can be mapped at the address it was laid out for,
+ * it is used as is: loading takes constant time and the memory of
+ * the image is shared by all processes mapping it. Otherwise the
+ * pointers in the image are relocated in a private copy.
+ *
+ * The document is read-only. It can be navigated, serialized and
+ * queried with XPath, also from multiple threads, but must not be
+ * modified. Nodes must not be unlinked or freed and the document
+ * must only be released with #xmlFreeDoc. Images must come from a
+ * trusted source: their content isn't validated.
+ *
+ * @since 2.16.0
+ *
+ * @param filename  the file name or URI
+ * @returns the document or NULL in case of error.
+ */
+xmlDoc *
+xmlDocMapImage(const char *filename) {
+    xmlDocImageHeader header;
+    void *map;
+    size_t size;
 
-	node = node->parent;
-    }
+    if (filename == NULL)
+        return(NULL);
 
+#if HAVE_DECL_MMAP
     /*
-     * The XML-1.0 namespace is normally held on the document
-     * element. In this case exceptionally create it on the
-     * node element.
+     * Map the file anywhere to read the header, then at the preferred
+     * address.
      */
-    if ((doc == NULL) && (IS_STR_XML(prefix))) {
-        cur = xmlNewXmlNs();
-        if (cur == NULL)
-            return(-1);
-        cur->next = parent->nsDef;
-        parent->nsDef = cur;
-        *out = cur;
+    if (xmlMapFile(filename, NULL, 0, &map, &size) != XML_ERR_OK)
+        return(NULL);
+    if (xmlDocImageCheck(map, size, &header) < 0) {
+        xmlUnmapFile(map, size);
+        return(NULL);
     }
+    if ((unsigned long long) XML_PTR_TO_INT(map) == header.base)
+        goto done;
+    xmlUnmapFile(map, size);
 
-    return(0);
+    if ((header.base != 0) &&
+        (xmlMapFile(filename, XML_INT_TO_PTR(header.base), 0, &map,
+                    &size) == XML_ERR_OK)) {
+        if ((xmlDocImageCheck(map, size, &header) == 0) &&
+            ((unsigned long long) XML_PTR_TO_INT(map) == header.base))
+            goto done;
+        xmlUnmapFile(map, size);
+    }
+#endif
+
+    if (xmlMapFile(filename, NULL, 1, &map, &size) != XML_ERR_OK)
+        return(NULL);
+    if ((xmlDocImageCheck(map, size, &header) < 0) ||
+        (xmlDocImageRelocate(map, &header) < 0)) {
+        xmlUnmapFile(map, size);
+        return(NULL);
+    }
+
+#if HAVE_DECL_MMAP
+done:
+#endif
+    return((xmlDocPtr) ((char *) map + XML_DOC_IMAGE_DOC));
+}
+
+/*
+ * Release a document returned by xmlDocMapImage.
+ */
+static void
+xmlDocUnmapImage(xmlDocPtr doc) {
+    const char *map = (const char *) doc - XML_DOC_IMAGE_DOC;
+    xmlDocImageHeader header;
+
+    memcpy(&header, map, sizeof(header));
+    xmlUnmapFile((void *) map, header.size);
 }
 
+/************************************************************************
+ *									*
+ *		Tree builder						*
+ *									*
+ ************************************************************************/
+
+/*
+ * A tree builder appends nodes in document order below a fixed
+ * parent. The element receiving new nodes is the cursor, so nodes are
+ * linked without searching the children. Text nodes are never merged,
+ * names are interned in the dictionary of the document once by the
+ * caller and namespaces are referenced by their index in nsTab.
+ *
+ * ID attributes and node registration callbacks are handled in a
+ * single pass over the new nodes by xmlTreeBuilderFinish.
+ */
+typedef struct {
+    xmlNodePtr node;
+    xmlAttrPtr lastAttr;
+    int nbNs;                   /* namespaces in scope of the parent */
+} xmlTreeBuilderLevel;
+
+struct _xmlTreeBuilder {
+    xmlDocPtr doc;
+    xmlDictPtr dict;
+    xmlNodePtr top;             /* the parent passed by the caller */
+    xmlNodePtr first;           /* first node added to top */
+    xmlNodePtr node;            /* the cursor */
+    xmlAttrPtr lastAttr;        /* last attribute of the cursor */
+    xmlTreeBuilderLevel *levels;
+    int nbLevels;
+    int maxLevels;
+    xmlNsPtr *nsTab;            /* namespaces in scope, then pending */
+    int nbNs;
+    int maxNs;
+    int nsStart;                /* first pending namespace */
+    int error;
+};
+
 /**
- * Search for a namespace with `prefix` in scope of `node`.
+ * Create a builder which appends nodes to the children of `parent`.
  *
- * Recurse on the parents until it finds the defined namespace
- * or return NULL otherwise.
+ * Names passed to the builder should be taken from the dictionary
+ * returned by #xmlTreeBuilderGetDict. A dictionary is attached to
+ * the document if it has none. Other names are looked up in the
+ * dictionary on each call.
  *
- * If `nameSpace` is NULL, the default namespace is looked up.
+ * With XML_TREE_BUILDER_ARENA, an arena is attached to the document
+ * if it has none and new nodes are allocated from the arena. The
+ * restrictions of XML_PARSE_ARENA apply to these nodes.
  *
- * Namespace search doesn't cross entity boundaries.
+ * The tree must not be modified by other means until
+ * #xmlTreeBuilderFinish is called.
+ *
+ * @since 2.16.0
  *
  * @param doc  the document
- * @param node  the current node
- * @param nameSpace  the namespace prefix
- * @returns the namespace pointer or NULL if no namespace was found or
- * a memory allocation failed. Allocations can only fail if the `xml`
- * namespace is queried.
+ * @param parent  an element or the document itself (optional)
+ * @param options  a combination of xmlTreeBuilderOption
+ * @returns the builder or NULL if arguments are invalid or a memory
+ * allocation failed.
  */
-xmlNs *
-xmlSearchNs(xmlDoc *doc ATTRIBUTE_UNUSED, xmlNode *node,
-            const xmlChar *nameSpace) {
-    xmlNsPtr cur;
+xmlTreeBuilder *
+xmlNewTreeBuilder(xmlDoc *doc, xmlNode *parent, int options) {
+    xmlTreeBuilderPtr builder;
+    xmlAttrPtr attr;
 
-    xmlSearchNsSafe(node, nameSpace, &cur);
-    return(cur);
+    if ((doc == NULL) || (doc->properties & XML_DOC_IMAGE))
+        return(NULL);
+    if (parent == NULL) {
+        parent = (xmlNodePtr) doc;
+    } else if ((parent->doc != doc) ||
+               ((parent->type != XML_ELEMENT_NODE) &&
+                (parent != (xmlNodePtr) doc))) {
+        return(NULL);
+    }
+
+    if (doc->dict == NULL) {
+        doc->dict = xmlDictCreate();
+        if (doc->dict == NULL)
+            return(NULL);
+    }
+    if ((options & XML_TREE_BUILDER_ARENA) && (doc->arena == NULL)) {
+        doc->arena = xmlArenaCreate();
+        if (doc->arena == NULL)
+            return(NULL);
+    }
+
+    builder = xmlMalloc(sizeof(*builder));
+    if (builder == NULL)
+        return(NULL);
+    memset(builder, 0, sizeof(*builder));
+    builder->doc = doc;
+    builder->dict = doc->dict;
+    builder->top = parent;
+    builder->node = parent;
+
+    if (parent->type == XML_ELEMENT_NODE) {
+        for (attr = parent->properties; attr != NULL; attr = attr->next)
+            builder->lastAttr = attr;
+    }
+
+    xmlDocIndexInvalidate(doc);
+    xmlNodeSourceChanged(parent);
+
+    return(builder);
 }
 
 /**
- * Verify that the given namespace held on `ancestor` is still in scope
- * on node.
+ * Free a tree builder. Elements which are still open stay in the
+ * tree, but #xmlTreeBuilderFinish should be called first.
  *
- * @param doc  the document
- * @param node  the current node
- * @param ancestor  the ancestor carrying the namespace
- * @param prefix  the namespace prefix
- * @returns 1 if true, 0 if false and -1 in case of error.
+ * @since 2.16.0
+ *
+ * @param builder  the builder (optional)
  */
-static int
-xmlNsInScope(xmlDocPtr doc ATTRIBUTE_UNUSED, xmlNodePtr node,
-             xmlNodePtr ancestor, const xmlChar * prefix)
-{
-    xmlNsPtr tst;
+void
+xmlFreeTreeBuilder(xmlTreeBuilder *builder) {
+    int i;
 
-    while ((node != NULL) && (node != ancestor)) {
-        if ((node->type == XML_ENTITY_REF_NODE) ||
-            (node->type == XML_ENTITY_DECL))
-            return (-1);
-        if (node->type == XML_ELEMENT_NODE) {
-            tst = node->nsDef;
-            while (tst != NULL) {
-                if ((tst->prefix == NULL)
-                    && (prefix == NULL))
-                    return (0);
-                if ((tst->prefix != NULL)
-                    && (prefix != NULL)
-                    && (xmlStrEqual(tst->prefix, prefix)))
-                    return (0);
-                tst = tst->next;
-            }
-        }
-        node = node->parent;
-    }
-    if (node != ancestor)
-        return (-1);
-    return (1);
+    if (builder == NULL)
+        return;
+
+    for (i = builder->nsStart; i < builder->nbNs; i++)
+        xmlFreeNs(builder->nsTab[i]);
+    xmlFree(builder->nsTab);
+    xmlFree(builder->levels);
+    xmlFree(builder);
 }
 
 /**
- * Search for a namespace matching `URI` in scope of `node`.
+ * @since 2.16.0
  *
- * @param node  a node
- * @param href  a namespace URI
- * @param out  pointer to resulting namespace
- * @returns 0 on success, -1 if a memory allocation failed, 1 on
- * other errors.
+ * @param builder  the builder
+ * @returns the dictionary of the document. Names from this
+ * dictionary are used without a lookup.
  */
-int
-xmlSearchNsByHrefSafe(xmlNode *node, const xmlChar *href,
-                      xmlNs **out) {
-    xmlNsPtr cur;
-    xmlDocPtr doc;
-    xmlNodePtr orig = node;
-    xmlNodePtr parent;
-    int is_attr;
+xmlDict *
+xmlTreeBuilderGetDict(xmlTreeBuilder *builder) {
+    if (builder == NULL)
+        return(NULL);
+    return(builder->dict);
+}
 
-    if (out == NULL)
-        return(1);
-    *out = NULL;
-    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
-        return(1);
+static const xmlChar *
+xmlTreeBuilderName(xmlTreeBuilderPtr builder, const xmlChar *name) {
+    const xmlChar *ret;
 
-    doc = node->doc;
+    if (xmlDictOwns(builder->dict, name) == 1)
+        return(name);
+    ret = xmlDictLookup(builder->dict, name, -1);
+    if (ret == NULL)
+        builder->error = 1;
+    return(ret);
+}
 
-    if ((doc != NULL) && (xmlStrEqual(href, XML_XML_NAMESPACE))) {
-        cur = xmlTreeEnsureXMLDecl(doc);
+/**
+ * Allocate a node and a copy of its content in one block if the
+ * document has an arena.
+ */
+static xmlNodePtr
+xmlTreeBuilderNewNode(xmlTreeBuilderPtr builder, xmlElementType type,
+                      const xmlChar *content, int len) {
+    xmlDocPtr doc = builder->doc;
+    xmlNodePtr cur;
+
+    if ((content != NULL) && (doc->arena != NULL)) {
+        cur = xmlArenaAlloc(doc->arena, sizeof(xmlNode) + len + 1);
         if (cur == NULL)
-            return(-1);
-        *out = cur;
-        return(0);
+            goto error;
+        memset(cur, 0, sizeof(xmlNode));
+        cur->content = (xmlChar *) (cur + 1);
+        memcpy(cur->content, content, len);
+        cur->content[len] = 0;
+    } else {
+        cur = xmlTreeAlloc(doc, sizeof(xmlNode));
+        if (cur == NULL)
+            goto error;
+        memset(cur, 0, sizeof(xmlNode));
+        if (content != NULL) {
+            cur->content = xmlStrndup(content, len);
+            if (cur->content == NULL) {
+                xmlTreeFree(doc, cur);
+                goto error;
+            }
+        }
     }
 
-    is_attr = (node->type == XML_ATTRIBUTE_NODE);
+    cur->type = type;
+    cur->doc = doc;
+    return(cur);
 
-    while (node->type != XML_ELEMENT_NODE) {
-        node = node->parent;
-        if (node == NULL)
-            return(0);
-    }
+error:
+    builder->error = 1;
+    return(NULL);
+}
 
-    parent = node;
+static void
+xmlTreeBuilderAppend(xmlTreeBuilderPtr builder, xmlNodePtr cur) {
+    xmlNodePtr parent = builder->node;
 
-    while ((node != NULL) && (node->type == XML_ELEMENT_NODE)) {
-        cur = node->nsDef;
-        while (cur != NULL) {
-            if (xmlStrEqual(cur->href, href)) {
-                if (((!is_attr) || (cur->prefix != NULL)) &&
-                    (xmlNsInScope(doc, orig, node, cur->prefix) == 1)) {
-                    *out = cur;
-                    return(0);
-                }
-            }
-            cur = cur->next;
-        }
-        if (orig != node) {
-            cur = node->ns;
-            if (cur != NULL) {
-                if (xmlStrEqual(cur->href, href)) {
-                    if (((!is_attr) || (cur->prefix != NULL)) &&
-                        (xmlNsInScope(doc, orig, node,
-                                      cur->prefix) == 1)) {
-                        *out = cur;
-                        return(0);
-                    }
-                }
-            }
-        }
+    cur->parent = parent;
+    if (parent->last == NULL) {
+        parent->children = cur;
+    } else {
+        cur->prev = parent->last;
+        parent->last->next = cur;
+    }
+    parent->last = cur;
 
-        node = node->parent;
+    if (builder->first == NULL)
+        builder->first = cur;
+}
+
+static xmlNsPtr
+xmlTreeBuilderGetNs(xmlTreeBuilderPtr builder, int ns, int *error) {
+    if (ns < 0) {
+        if (ns != -1)
+            *error = 1;
+        return(NULL);
     }
+    if (ns >= builder->nsStart) {
+        *error = 1;
+        return(NULL);
+    }
+    return(builder->nsTab[ns]);
+}
 
-    /*
-     * The XML-1.0 namespace is normally held on the document
-     * element. In this case exceptionally create it on the
-     * node element.
-     */
-    if ((doc == NULL) && (xmlStrEqual(href, XML_XML_NAMESPACE))) {
-        cur = xmlNewXmlNs();
-        if (cur == NULL)
+/**
+ * Declare a namespace on the next element started with
+ * #xmlTreeBuilderStartElement. The namespace can be used by this
+ * element, its attributes and its descendants.
+ *
+ * @since 2.16.0
+ *
+ * @param builder  the builder
+ * @param href  the namespace URI
+ * @param prefix  the prefix (optional)
+ * @returns the index of the namespace or -1 if arguments are invalid,
+ * the prefix was already declared for the next element or a memory
+ * allocation failed.
+ */
+int
+xmlTreeBuilderDeclareNs(xmlTreeBuilder *builder, const xmlChar *href,
+                        const xmlChar *prefix) {
+    xmlNsPtr ns;
+    int i;
+
+    if ((builder == NULL) || (builder->error) || (href == NULL))
+        return(-1);
+
+    for (i = builder->nsStart; i < builder->nbNs; i++) {
+        if (xmlStrEqual(builder->nsTab[i]->prefix, prefix))
             return(-1);
-        cur->next = parent->nsDef;
-        parent->nsDef = cur;
-        *out = cur;
     }
 
-    return(0);
+    if (builder->nbNs >= builder->maxNs) {
+        xmlNsPtr *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(builder->maxNs, sizeof(tmp[0]),
+                                  8, XML_MAX_ITEMS);
+        if (newSize < 0)
+            goto error;
+        tmp = xmlRealloc(builder->nsTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto error;
+        builder->nsTab = tmp;
+        builder->maxNs = newSize;
+    }
+
+    ns = xmlNewNs(NULL, href, prefix);
+    if (ns == NULL)
+        goto error;
+    xmlDictNsId(builder->doc->dict, href, 1);
+    builder->nsTab[builder->nbNs] = ns;
+    return(builder->nbNs++);
+
+error:
+    builder->error = 1;
+    return(-1);
 }
 
 /**
- * Search for a namespace matching `URI` in scope of `node`.
+ * Start an element and make it the cursor. Attributes and children
+ * are added to the element until #xmlTreeBuilderEndElement is
+ * called. Pending namespace declarations are added to the element.
  *
- * @param doc  the document
- * @param node  the current node
- * @param href  the namespace value
- * @returns the namespace pointer or NULL if no namespace was found or
- * a memory allocation failed. Allocations can only fail if the `xml`
- * namespace is queried.
+ * @since 2.16.0
+ *
+ * @param builder  the builder
+ * @param ns  the index of the namespace or -1
+ * @param name  the local name
+ * @returns 0 on success or -1 if arguments are invalid or a memory
+ * allocation failed.
  */
-xmlNs *
-xmlSearchNsByHref(xmlDoc *doc ATTRIBUTE_UNUSED, xmlNode *node,
-                  const xmlChar * href) {
-    xmlNsPtr cur;
+int
+xmlTreeBuilderStartElement(xmlTreeBuilder *builder, int ns,
+                           const xmlChar *name) {
+    xmlTreeBuilderLevel *level;
+    xmlNodePtr cur;
+    xmlNsPtr nsPtr;
+    int error = 0;
+    int i;
 
-    xmlSearchNsByHrefSafe(node, href, &cur);
-    return(cur);
+    if ((builder == NULL) || (builder->error) || (name == NULL))
+        return(-1);
+    /* Pending namespaces can be used by the element itself */
+    if ((ns >= builder->nsStart) && (ns < builder->nbNs))
+        nsPtr = builder->nsTab[ns];
+    else
+        nsPtr = xmlTreeBuilderGetNs(builder, ns, &error);
+    if (error)
+        return(-1);
+
+    if (builder->nbLevels >= builder->maxLevels) {
+        xmlTreeBuilderLevel *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(builder->maxLevels, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            goto error;
+        tmp = xmlRealloc(builder->levels, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto error;
+        builder->levels = tmp;
+        builder->maxLevels = newSize;
+    }
+
+    name = xmlTreeBuilderName(builder, name);
+    if (name == NULL)
+        return(-1);
+    cur = xmlTreeBuilderNewNode(builder, XML_ELEMENT_NODE, NULL, 0);
+    if (cur == NULL)
+        return(-1);
+    cur->name = name;
+    cur->ns = nsPtr;
+
+    for (i = builder->nbNs - 1; i >= builder->nsStart; i--) {
+        builder->nsTab[i]->next = cur->nsDef;
+        cur->nsDef = builder->nsTab[i];
+    }
+
+    xmlTreeBuilderAppend(builder, cur);
+
+    level = &builder->levels[builder->nbLevels++];
+    level->node = builder->node;
+    level->lastAttr = builder->lastAttr;
+    level->nbNs = builder->nsStart;
+    builder->node = cur;
+    builder->lastAttr = NULL;
+    builder->nsStart = builder->nbNs;
+
+    return(0);
+
+error:
+    builder->error = 1;
+    return(-1);
 }
 
 /**
- * Fix up namespace declarations.
+ * End the element at the cursor and move the cursor to its parent.
+ * Pending namespace declarations are discarded.
  *
- * This function tries to locate a namespace definition in a tree
- * ancestors, or create a new namespace definition node similar to
- * `ns` trying to reuse the same prefix. However if the given prefix is
- * null (default namespace) or reused within the subtree defined by
- * `tree` or on one of its ancestors then a new prefix is generated.
+ * @since 2.16.0
  *
- * @param tree  a node expected to hold the new namespace
- * @param ns  the original namespace
- * @returns the (new) namespace definition or NULL in case of error
+ * @param builder  the builder
+ * @returns 0 on success or -1 if no element was started.
  */
-static xmlNsPtr
-xmlNewReconciledNs(xmlNodePtr tree, xmlNsPtr ns) {
-    xmlNsPtr def;
-    xmlChar prefix[50];
-    int counter = 1;
-    int res;
+int
+xmlTreeBuilderEndElement(xmlTreeBuilder *builder) {
+    xmlTreeBuilderLevel *level;
+    int i;
 
-    if ((tree == NULL) || (tree->type != XML_ELEMENT_NODE)) {
-	return(NULL);
-    }
-    if ((ns == NULL) || (ns->type != XML_NAMESPACE_DECL)) {
-	return(NULL);
-    }
-    /*
-     * Search an existing namespace definition inherited.
-     */
-    res = xmlSearchNsByHrefSafe(tree, ns->href, &def);
-    if (res < 0)
-        return(NULL);
-    if (def != NULL)
-        return(def);
+    if ((builder == NULL) || (builder->nbLevels <= 0))
+        return(-1);
 
-    /*
-     * Find a close prefix which is not already in use.
-     * Let's strip namespace prefixes longer than 20 chars !
-     */
-    if (ns->prefix == NULL)
-	snprintf((char *) prefix, sizeof(prefix), "default");
-    else
-	snprintf((char *) prefix, sizeof(prefix), "%.20s", (char *)ns->prefix);
+    for (i = builder->nsStart; i < builder->nbNs; i++)
+        xmlFreeNs(builder->nsTab[i]);
 
-    res = xmlSearchNsSafe(tree, prefix, &def);
-    if (res < 0)
-        return(NULL);
-    while (def != NULL) {
-        if (counter > 1000) return(NULL);
-	if (ns->prefix == NULL)
-	    snprintf((char *) prefix, sizeof(prefix), "default%d", counter++);
-	else
-	    snprintf((char *) prefix, sizeof(prefix), "%.20s%d",
-		(char *)ns->prefix, counter++);
-	res = xmlSearchNsSafe(tree, prefix, &def);
-        if (res < 0)
-            return(NULL);
-    }
+    level = &builder->levels[--builder->nbLevels];
+    builder->node = level->node;
+    builder->lastAttr = level->lastAttr;
+    builder->nbNs = level->nbNs;
+    builder->nsStart = level->nbNs;
 
-    /*
-     * OK, now we are ready to create a new one.
-     */
-    def = xmlNewNs(tree, ns->href, prefix);
-    return(def);
+    return(0);
 }
 
-typedef struct {
-    xmlNsPtr oldNs;
-    xmlNsPtr newNs;
-} xmlNsCache;
+/**
+ * Add an attribute to the element at the cursor. The builder doesn't
+ * check for duplicate attributes.
+ *
+ * @since 2.16.0
+ *
+ * @param builder  the builder
+ * @param ns  the index of a namespace with a prefix or -1
+ * @param name  the local name
+ * @param value  the attribute value without references
+ * @param len  length of the value or -1 if it is zero-terminated
+ * @returns 0 on success or -1 if arguments are invalid or a memory
+ * allocation failed.
+ */
+int
+xmlTreeBuilderAttribute(xmlTreeBuilder *builder, int ns,
+                        const xmlChar *name, const xmlChar *value,
+                        int len) {
+    xmlAttrPtr attr;
+    xmlNodePtr text;
+    xmlNsPtr nsPtr;
+    int error = 0;
 
-static int
-xmlGrowNsCache(xmlNsCache **cache, int *capacity) {
-    xmlNsCache *tmp;
-    int newSize;
+    if ((builder == NULL) || (builder->error) || (name == NULL) ||
+        (value == NULL) || (builder->node->type != XML_ELEMENT_NODE))
+        return(-1);
+    nsPtr = xmlTreeBuilderGetNs(builder, ns, &error);
+    if ((error) || ((nsPtr != NULL) && (nsPtr->prefix == NULL)))
+        return(-1);
+    if (len < 0)
+        len = xmlStrlen(value);
 
-    newSize = xmlGrowCapacity(*capacity, sizeof(tmp[0]),
-                              10, XML_MAX_ITEMS);
-    if (newSize < 0)
+    name = xmlTreeBuilderName(builder, name);
+    if (name == NULL)
         return(-1);
-    tmp = xmlRealloc(*cache, newSize * sizeof(tmp[0]));
-    if (tmp == NULL)
+    text = xmlTreeBuilderNewNode(builder, XML_TEXT_NODE, value, len);
+    if (text == NULL)
         return(-1);
-    *cache = tmp;
-    *capacity = newSize;
+    text->name = xmlStringText;
+    attr = xmlTreeAlloc(builder->doc, sizeof(xmlAttr));
+    if (attr == NULL) {
+        builder->error = 1;
+        xmlFreeNode(text);
+        return(-1);
+    }
+    memset(attr, 0, sizeof(xmlAttr));
+    attr->type = XML_ATTRIBUTE_NODE;
+    attr->name = name;
+    attr->ns = nsPtr;
+    attr->doc = builder->doc;
+    attr->parent = builder->node;
+    attr->children = text;
+    attr->last = text;
+    text->parent = (xmlNodePtr) attr;
+
+    if (builder->lastAttr == NULL) {
+        builder->node->properties = attr;
+    } else {
+        attr->prev = builder->lastAttr;
+        builder->lastAttr->next = attr;
+    }
+    builder->lastAttr = attr;
 
     return(0);
 }
 
 /**
- * This function checks that all the namespaces declared within the given
- * tree are properly declared. This is needed for example after copy or cut
- * and then paste operations. The subtree may still hold pointers to
- * namespace declarations outside the subtree or invalid/masked. As much
- * as possible the function tries to reuse the existing namespaces found in
- * the new environment. If not possible the new namespaces are redeclared
- * on `tree` at the top of the given subtree.
+ * Append a text node to the cursor. The text isn't merged with
+ * adjacent text nodes.
  *
- * @param doc  the document
- * @param tree  a node defining the subtree to reconciliate
- * @returns 0 on success or -1 in case of error.
+ * @since 2.16.0
+ *
+ * @param builder  the builder
+ * @param content  the text without references
+ * @param len  length of the text or -1 if it is zero-terminated
+ * @returns 0 on success or -1 if arguments are invalid or a memory
+ * allocation failed.
  */
 int
-xmlReconciliateNs(xmlDoc *doc, xmlNode *tree) {
-    xmlNsCache *cache = NULL;
-    int sizeCache = 0;
-    int nbCache = 0;
+xmlTreeBuilderText(xmlTreeBuilder *builder, const xmlChar *content,
+                   int len) {
+    xmlNodePtr cur;
 
-    xmlNsPtr n;
-    xmlNodePtr node = tree;
+    if ((builder == NULL) || (builder->error) || (content == NULL))
+        return(-1);
+    if (len < 0)
+        len = xmlStrlen(content);
+
+    cur = xmlTreeBuilderNewNode(builder, XML_TEXT_NODE, content, len);
+    if (cur == NULL)
+        return(-1);
+    cur->name = xmlStringText;
+    xmlTreeBuilderAppend(builder, cur);
+
+    return(0);
+}
+
+/**
+ * Register a new node and its attributes.
+ */
+static int
+xmlTreeBuilderFixup(xmlDocPtr doc, xmlNodePtr cur, int callbacks) {
     xmlAttrPtr attr;
-    int ret = 0, i;
+    int res;
 
-    if ((node == NULL) || (node->type != XML_ELEMENT_NODE)) return(-1);
-    if (node->doc != doc) return(-1);
-    while (node != NULL) {
-        /*
-	 * Reconciliate the node namespace
-	 */
-	if (node->ns != NULL) {
-	    for (i = 0; i < nbCache; i++) {
-	        if (cache[i].oldNs == node->ns) {
-		    node->ns = cache[i].newNs;
-		    break;
-		}
-	    }
-	    if (i == nbCache) {
-	        /*
-		 * OK we need to recreate a new namespace definition
-		 */
-		n = xmlNewReconciledNs(tree, node->ns);
-		if (n == NULL) {
-                    ret = -1;
-                } else {
-		    /*
-		     * check if we need to grow the cache buffers.
-		     */
-		    if ((sizeCache <= nbCache) &&
-                        (xmlGrowNsCache(&cache, &sizeCache) < 0)) {
-                        ret = -1;
-		    } else {
-                        cache[nbCache].newNs = n;
-                        cache[nbCache++].oldNs = node->ns;
-                    }
-                }
-		node->ns = n;
-	    }
-	}
-	/*
-	 * now check for namespace held by attributes on the node.
-	 */
-	if (node->type == XML_ELEMENT_NODE) {
-	    attr = node->properties;
-	    while (attr != NULL) {
-		if (attr->ns != NULL) {
-		    for (i = 0; i < nbCache; i++) {
-			if (cache[i].oldNs == attr->ns) {
-			    attr->ns = cache[i].newNs;
-			    break;
-			}
-		    }
-		    if (i == nbCache) {
-			/*
-			 * OK we need to recreate a new namespace definition
-			 */
-			n = xmlNewReconciledNs(tree, attr->ns);
-			if (n == NULL) {
-                            ret = -1;
-                        } else {
-			    /*
-			     * check if we need to grow the cache buffers.
-			     */
-                            if ((sizeCache <= nbCache) &&
-                                (xmlGrowNsCache(&cache, &sizeCache) < 0)) {
-                                ret = -1;
-                            } else {
-                                cache[nbCache].newNs = n;
-                                cache[nbCache++].oldNs = attr->ns;
-			    }
-			}
-			attr->ns = n;
-		    }
-		}
-		attr = attr->next;
-	    }
-	}
+    if (callbacks)
+        xmlRegisterNodeDefaultValue(cur);
+    if (cur->type != XML_ELEMENT_NODE)
+        return(0);
 
-	/*
-	 * Browse the full subtree, deep first
-	 */
-        if ((node->children != NULL) && (node->type != XML_ENTITY_REF_NODE)) {
-	    /* deep first */
-	    node = node->children;
-	} else if ((node != tree) && (node->next != NULL)) {
-	    /* then siblings */
-	    node = node->next;
-	} else if (node != tree) {
-	    /* go up to parents->next if needed */
-	    while (node != tree) {
-	        if (node->parent != NULL)
-		    node = node->parent;
-		if ((node != tree) && (node->next != NULL)) {
-		    node = node->next;
-		    break;
-		}
-		if (node->parent == NULL) {
-		    node = NULL;
-		    break;
-		}
-	    }
-	    /* exit condition */
-	    if (node == tree)
-	        node = NULL;
-	} else
-	    break;
+    for (attr = cur->properties; attr != NULL; attr = attr->next) {
+        if (callbacks) {
+            xmlRegisterNodeDefaultValue((xmlNodePtr) attr);
+            xmlRegisterNodeDefaultValue(attr->children);
+        }
+        res = xmlIsID(doc, cur, attr);
+        if (res < 0)
+            return(-1);
+        if ((res == 1) &&
+            (xmlAddIDSafe(attr, attr->children->content) < 0))
+            return(-1);
     }
-    if (cache != NULL)
-	xmlFree(cache);
-    return(ret);
-}
 
-static xmlAttrPtr
-xmlGetPropNodeInternal(const xmlNode *node, const xmlChar *name,
-		       const xmlChar *nsName, int useDTD)
-{
-    xmlAttrPtr prop;
-
-    /* Avoid unused variable warning if features are disabled. */
-    (void) useDTD;
+    return(0);
+}
 
-    if ((node == NULL) || (node->type != XML_ELEMENT_NODE) || (name == NULL))
-	return(NULL);
+/**
+ * End all open elements and complete the new nodes. ID attributes
+ * are added to the ID table of the document and the node
+ * registration callback is invoked.
+ *
+ * The builder can be used to append more nodes afterwards.
+ *
+ * @since 2.16.0
+ *
+ * @param builder  the builder
+ * @returns 0 on success or -1 if a previous call or the fixup failed
+ * with a memory allocation error.
+ */
+int
+xmlTreeBuilderFinish(xmlTreeBuilder *builder) {
+    xmlNodePtr cur, top;
+    int callbacks;
 
-    if (node->properties != NULL) {
-	prop = node->properties;
-	if (nsName == NULL) {
-	    /*
-	    * We want the attr to be in no namespace.
-	    */
-	    do {
-		if ((prop->ns == NULL) && xmlStrEqual(prop->name, name)) {
-		    return(prop);
-		}
-		prop = prop->next;
-	    } while (prop != NULL);
-	} else {
-	    /*
-	    * We want the attr to be in the specified namespace.
-	    */
-	    do {
-		if ((prop->ns != NULL) && xmlStrEqual(prop->name, name) &&
-		    ((prop->ns->href == nsName) ||
-		     xmlStrEqual(prop->ns->href, nsName)))
-		{
-		    return(prop);
-		}
-		prop = prop->next;
-	    } while (prop != NULL);
-	}
-    }
+    if (builder == NULL)
+        return(-1);
+    while (builder->nbLevels > 0)
+        xmlTreeBuilderEndElement(builder);
 
-    if (! useDTD)
-	return(NULL);
-    /*
-     * Check if there is a default/fixed attribute declaration in
-     * the internal or external subset.
-     */
-    if ((node->doc != NULL) && (node->doc->intSubset != NULL)) {
-	xmlDocPtr doc = node->doc;
-	xmlAttributePtr attrDecl = NULL;
-	xmlChar *elemQName, *tmpstr = NULL;
+    callbacks = (xmlRegisterCallbacks) && (xmlRegisterNodeDefaultValue);
+    top = builder->top;
+    cur = builder->first;
+    builder->first = NULL;
 
-	/*
-	* We need the QName of the element for the DTD-lookup.
-	*/
-	if ((node->ns != NULL) && (node->ns->prefix != NULL)) {
-	    tmpstr = xmlStrdup(node->ns->prefix);
-	    if (tmpstr == NULL)
-		return(NULL);
-	    tmpstr = xmlStrcat(tmpstr, BAD_CAST ":");
-	    if (tmpstr == NULL)
-		return(NULL);
-	    tmpstr = xmlStrcat(tmpstr, node->name);
-	    if (tmpstr == NULL)
-		return(NULL);
-	    elemQName = tmpstr;
-	} else
-	    elemQName = (xmlChar *) node->name;
-	if (nsName == NULL) {
-	    /*
-	    * The common and nice case: Attr in no namespace.
-	    */
-	    attrDecl = xmlGetDtdQAttrDesc(doc->intSubset,
-		elemQName, name, NULL);
-	    if ((attrDecl == NULL) && (doc->extSubset != NULL)) {
-		attrDecl = xmlGetDtdQAttrDesc(doc->extSubset,
-		    elemQName, name, NULL);
-	    }
-        } else if (xmlStrEqual(nsName, XML_XML_NAMESPACE)) {
-	    /*
-	    * The XML namespace must be bound to prefix 'xml'.
-	    */
-	    attrDecl = xmlGetDtdQAttrDesc(doc->intSubset,
-		elemQName, name, BAD_CAST "xml");
-	    if ((attrDecl == NULL) && (doc->extSubset != NULL)) {
-		attrDecl = xmlGetDtdQAttrDesc(doc->extSubset,
-		    elemQName, name, BAD_CAST "xml");
-	    }
-	} else {
-	    xmlNsPtr *nsList, *cur;
+    /* Visit the new nodes in document order */
+    while (cur != NULL) {
+        if (xmlTreeBuilderFixup(builder->doc, cur, callbacks) < 0)
+            builder->error = 1;
 
-	    /*
-	    * The ugly case: Search using the prefixes of in-scope
-	    * ns-decls corresponding to @nsName.
-	    */
-	    nsList = xmlGetNsList(node->doc, node);
-	    if (nsList == NULL) {
-		if (tmpstr != NULL)
-		    xmlFree(tmpstr);
-		return(NULL);
-	    }
-	    cur = nsList;
-	    while (*cur != NULL) {
-		if (xmlStrEqual((*cur)->href, nsName)) {
-		    attrDecl = xmlGetDtdQAttrDesc(doc->intSubset, elemQName,
-			name, (*cur)->prefix);
-		    if (attrDecl)
-			break;
-		    if (doc->extSubset != NULL) {
-			attrDecl = xmlGetDtdQAttrDesc(doc->extSubset, elemQName,
-			    name, (*cur)->prefix);
-			if (attrDecl)
-			    break;
-		    }
-		}
-		cur++;
-	    }
-	    xmlFree(nsList);
-	}
-	if (tmpstr != NULL)
-	    xmlFree(tmpstr);
-	/*
-	* Only default/fixed attrs are relevant.
-	*/
-	if ((attrDecl != NULL) && (attrDecl->defaultValue != NULL))
-	    return((xmlAttrPtr) attrDecl);
+        if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+            cur = cur->children;
+            continue;
+        }
+        while ((cur != top) && (cur->next == NULL))
+            cur = cur->parent;
+        if (cur == top)
+            break;
+        cur = cur->next;
     }
 
-    return(NULL);
-}
+    xmlDocIndexInvalidate(builder->doc);
 
-static xmlChar*
-xmlGetPropNodeValueInternal(const xmlAttr *prop)
-{
-    if (prop == NULL)
-	return(NULL);
-    if (prop->type == XML_ATTRIBUTE_NODE) {
-	return(xmlNodeGetContent((xmlNodePtr) prop));
-    } else if (prop->type == XML_ATTRIBUTE_DECL) {
-	return(xmlStrdup(((xmlAttributePtr)prop)->defaultValue));
-    }
-    return(NULL);
+    return(builder->error ? -1 : 0);
 }
 
+/************************************************************************
+ *									*
+ *		Content access functions				*
+ *									*
+ ************************************************************************/
+
 /**
- * Search for an attribute of an element.
- *
- * This function also looks in DTD attribute declaration for \#FIXED or
- * default declaration values.
+ * Get line number of `node`. Try to work around the limitation of
+ * line numbers being stored as 16 bits ints. Requires xmlParserOption
+ * XML_PARSE_BIG_LINES to be set when parsing.
  *
- * @param node  the element
- * @param name  the attribute name
- * @returns the attribute or the attribute declaration or NULL if
- * neither was found. Also returns NULL if a memory allocation failed,
- * making this function unreliable.
+ * @param node  valid node
+ * @param depth  used to limit any risk of recursion
+ * @returns the line number if successful, -1 otherwise
  */
-xmlAttr *
-xmlHasProp(const xmlNode *node, const xmlChar *name) {
-    xmlAttrPtr prop;
-    xmlDocPtr doc;
+static long
+xmlGetLineNoInternal(const xmlNode *node, int depth)
+{
+    long result = -1;
 
-    if ((node == NULL) || (node->type != XML_ELEMENT_NODE) || (name == NULL))
-        return(NULL);
-    /*
-     * Check on the properties attached to the node
-     */
-    prop = node->properties;
-    while (prop != NULL) {
-        if (xmlStrEqual(prop->name, name))  {
-	    return(prop);
-        }
-	prop = prop->next;
-    }
+    if (depth >= 5)
+        return(-1);
 
-    /*
-     * Check if there is a default declaration in the internal
-     * or external subsets
-     */
-    doc =  node->doc;
-    if (doc != NULL) {
-        xmlAttributePtr attrDecl;
-        if (doc->intSubset != NULL) {
-	    attrDecl = xmlGetDtdAttrDesc(doc->intSubset, node->name, name);
-	    if ((attrDecl == NULL) && (doc->extSubset != NULL))
-		attrDecl = xmlGetDtdAttrDesc(doc->extSubset, node->name, name);
-            if ((attrDecl != NULL) && (attrDecl->defaultValue != NULL))
-              /* return attribute declaration only if a default value is given
-                 (that includes #FIXED declarations) */
-		return((xmlAttrPtr) attrDecl);
+    if (!node)
+        return result;
+    if ((node->type == XML_ELEMENT_NODE) ||
+        (node->type == XML_TEXT_NODE) ||
+	(node->type == XML_COMMENT_NODE) ||
+	(node->type == XML_PI_NODE)) {
+	if (node->line == 65535) {
+	    if ((node->type == XML_TEXT_NODE) && (node->psvi != NULL))
+	        result = XML_PTR_TO_INT(node->psvi);
+	    else if ((node->type == XML_ELEMENT_NODE) &&
+	             (node->children != NULL))
+	        result = xmlGetLineNoInternal(node->children, depth + 1);
+	    else if (node->next != NULL)
+	        result = xmlGetLineNoInternal(node->next, depth + 1);
+	    else if (node->prev != NULL)
+	        result = xmlGetLineNoInternal(node->prev, depth + 1);
 	}
-    }
-    return(NULL);
-}
-
-/**
- * Search for an attribute of an element.
- *
- * The attribute has to match the specified namespace. A namespace of
- * NULL means that the attribute must have no namespace.
- *
- * This function also looks in DTD attribute declaration for \#FIXED or
- * default declaration values.
- *
- * @param node  the element
- * @param name  the attribute name
- * @param nameSpace  the URI of the namespace
- * @returns the attribute or the attribute declaration or NULL if
- * neither was found. Also returns NULL if a memory allocation failed
- * making this function unreliable.
- */
-xmlAttr *
-xmlHasNsProp(const xmlNode *node, const xmlChar *name, const xmlChar *nameSpace) {
+	if ((result == -1) || (result == 65535))
+	    result = node->line;
+    } else if ((node->prev != NULL) &&
+             ((node->prev->type == XML_ELEMENT_NODE) ||
+	      (node->prev->type == XML_TEXT_NODE) ||
+	      (node->prev->type == XML_COMMENT_NODE) ||
+	      (node->prev->type == XML_PI_NODE)))
+        result = xmlGetLineNoInternal(node->prev, depth + 1);
+    else if ((node->parent != NULL) &&
+             (node->parent->type == XML_ELEMENT_NODE))
+        result = xmlGetLineNoInternal(node->parent, depth + 1);
 
-    return(xmlGetPropNodeInternal(node, name, nameSpace, 1));
+    return result;
 }
 
 /**
- * Look up the value of an element's attribute.
- *
- * The attribute has to match the specified namespace. A namespace of
- * NULL means that the attribute must have no namespace.
- *
- * Entities are substituted. The returned value must be freed by the
- * caller.
- *
- * @since 2.13.0
+ * Get line number of `node`. Try to work around the limitation of
+ * line numbers being stored as 16 bits ints. Requires xmlParserOption
+ * XML_PARSE_BIG_LINES to be set when parsing.
  *
- * @param node  the element
- * @param name  the attribute name
- * @param nsUri  the URI of the namespace
- * @param out  the returned string
- * @returns 0 on success, 1 if no attribute was found, -1 if a
- * memory allocation failed.
+ * @param node  valid node
+ * @returns the line number if successful, -1 otherwise
  */
-int
-xmlNodeGetAttrValue(const xmlNode *node, const xmlChar *name,
-                    const xmlChar *nsUri, xmlChar **out) {
-    xmlAttrPtr prop;
-
-    if (out == NULL)
-        return(1);
-    *out = NULL;
-
-    prop = xmlGetPropNodeInternal(node, name, nsUri, 0);
-    if (prop == NULL)
-	return(1);
-
-    *out = xmlGetPropNodeValueInternal(prop);
-    if (*out == NULL)
-        return(-1);
-    return(0);
+long
+xmlGetLineNo(const xmlNode *node)
+{
+    return(xmlGetLineNoInternal(node, 0));
 }
 
 /**
- * Look up the value of an element's attribute.
- *
- * Entities are substituted. The returned value must be freed by the
- * caller.
- *
- * This function looks in DTD attribute declarations for \#FIXED or
- * default declaration values.
- *
- * NOTE: This function is ignores namespaces. Use #xmlGetNsProp or
- * #xmlGetNoNsProp for namespace aware processing.
- *
- * NOTE: This function doesn't allow to distinguish malloc failures from
- * missing attributes.
+ * Build a structure based Path for the given node
  *
- * @param node  the element
- * @param name  the attribute name
- * @returns the attribute value or NULL if not found or a memory allocation
- * failed.
+ * @param node  a node
+ * @returns the new path or NULL in case of error. The caller must free
+ *     the returned string
  */
 xmlChar *
-xmlGetProp(const xmlNode *node, const xmlChar *name) {
-    xmlAttrPtr prop;
+xmlGetNodePath(const xmlNode *node)
+{
+    const xmlNode *cur, *tmp;
+    const xmlNode **nodes = NULL;
+    xmlChar *ret = NULL;
+    xmlBuf *buf;
+    size_t numNodes, i;
 
-    prop = xmlHasProp(node, name);
-    if (prop == NULL)
-	return(NULL);
-    return(xmlGetPropNodeValueInternal(prop));
-}
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
+        return(NULL);
 
-/**
- * Look up the value of an element's attribute.
- *
- * Entities are substituted. The returned value must be freed by the
- * caller.
- *
- * This function looks in DTD attribute declarations for \#FIXED or
- * default declaration values.
- *
- * This function is similar to #xmlGetProp except it will accept only
- * an attribute in no namespace.
- *
- * NOTE: This function doesn't allow to distinguish malloc failures from
- * missing attributes. It's more robust to use #xmlNodeGetAttrValue.
- *
- * @param node  the element
- * @param name  the attribute name
- * @returns the attribute value or NULL if not found or a memory allocation
- * failed.
- */
-xmlChar *
-xmlGetNoNsProp(const xmlNode *node, const xmlChar *name) {
-    xmlAttrPtr prop;
+    buf = xmlBufCreate(50);
+    if (buf == NULL)
+        return(NULL);
 
-    prop = xmlGetPropNodeInternal(node, name, NULL, 1);
-    if (prop == NULL)
-	return(NULL);
-    return(xmlGetPropNodeValueInternal(prop));
-}
+    /*
+     * Get list of ancestors
+     */
+    numNodes = 0;
+    for (cur = node; cur != NULL; cur = cur->parent)
+        numNodes += 1;
+    if (numNodes > SIZE_MAX / sizeof(nodes[0]))
+        goto error;
+    nodes = xmlMalloc(numNodes * sizeof(nodes[0]));
+    if (nodes == NULL)
+        goto error;
+    i = 0;
+    for (cur = node; cur != NULL && i < numNodes; cur = cur->parent)
+        nodes[i++] = cur;
 
-/**
- * Look up the value of an element's attribute.
- *
- * The attribute has to match the specified namespace. A namespace of
- * NULL means that the attribute must have no namespace.
- *
- * Entities are substituted. The returned value must be freed by the
- * caller.
- *
- * This function looks in DTD attribute declaration for \#FIXED or
- * default declaration values.
- *
- * NOTE: This function doesn't allow to distinguish malloc failures from
- * missing attributes. It's more robust to use #xmlNodeGetAttrValue.
- *
- * @param node  the element
- * @param name  the attribute name
- * @param nameSpace  the URI of the namespace
- * @returns the attribute value or NULL if not found or a memory allocation
- * failed.
- */
-xmlChar *
-xmlGetNsProp(const xmlNode *node, const xmlChar *name, const xmlChar *nameSpace) {
-    xmlAttrPtr prop;
+    /*
+     * Iterate in reverse to start at root
+     */
+    while (i > 0) {
+        int occur = 0;
 
-    prop = xmlGetPropNodeInternal(node, name, nameSpace, 1);
-    if (prop == NULL)
-	return(NULL);
-    return(xmlGetPropNodeValueInternal(prop));
-}
+        i -= 1;
+        cur = nodes[i];
 
-/**
- * Remove an attribute of an element.
- * This handles only attributes in no namespace.
- *
- * @param node  the element
- * @param name  the attribute name
- * @returns 0 if successful, -1 if not found
- */
-int
-xmlUnsetProp(xmlNode *node, const xmlChar *name) {
-    xmlAttrPtr prop;
+        if ((cur->type == XML_DOCUMENT_NODE) ||
+            (cur->type == XML_HTML_DOCUMENT_NODE)) {
+            if (i == 0)
+                xmlBufCat(buf, BAD_CAST "/");
+        } else if (cur->type == XML_ELEMENT_NODE) {
+            int generic = 0;
 
-    prop = xmlGetPropNodeInternal(node, name, NULL, 0);
-    if (prop == NULL)
-	return(-1);
-    xmlUnlinkNodeInternal((xmlNodePtr) prop);
-    xmlFreeProp(prop);
-    return(0);
-}
+            xmlBufCat(buf, BAD_CAST "/");
 
-/**
- * Remove an attribute of an element.
- *
- * @param node  the element
- * @param ns  the namespace definition
- * @param name  the attribute name
- * @returns 0 if successful, -1 if not found
- */
-int
-xmlUnsetNsProp(xmlNode *node, xmlNs *ns, const xmlChar *name) {
-    xmlAttrPtr prop;
+            if (cur->ns) {
+		if (cur->ns->prefix != NULL) {
+                    xmlBufCat(buf, cur->ns->prefix);
+                    xmlBufCat(buf, BAD_CAST ":");
+                    xmlBufCat(buf, cur->name);
+		} else {
+		    /*
+		    * We cannot express named elements in the default
+		    * namespace, so use "*".
+		    */
+		    generic = 1;
+                    xmlBufCat(buf, BAD_CAST "*");
+		}
+            } else {
+                xmlBufCat(buf, cur->name);
+            }
 
-    prop = xmlGetPropNodeInternal(node, name,
-                                  (ns != NULL) ? ns->href : NULL, 0);
-    if (prop == NULL)
-	return(-1);
-    xmlUnlinkNodeInternal((xmlNodePtr) prop);
-    xmlFreeProp(prop);
-    return(0);
+            /*
+             * Thumbler index computation
+	     * TODO: the occurrence test seems bogus for namespaced names
+             */
+            tmp = cur->prev;
+            while (tmp != NULL) {
+                if ((tmp->type == XML_ELEMENT_NODE) &&
+		    (generic ||
+		     (xmlStrEqual(cur->name, tmp->name) &&
+		     ((tmp->ns == cur->ns) ||
+		      ((tmp->ns != NULL) && (cur->ns != NULL) &&
+		       (xmlStrEqual(cur->ns->prefix, tmp->ns->prefix)))))))
+                    occur++;
+                tmp = tmp->prev;
+            }
+            if (occur == 0) {
+                tmp = cur->next;
+                while (tmp != NULL && occur == 0) {
+                    if ((tmp->type == XML_ELEMENT_NODE) &&
+			(generic ||
+			 (xmlStrEqual(cur->name, tmp->name) &&
+			 ((tmp->ns == cur->ns) ||
+			  ((tmp->ns != NULL) && (cur->ns != NULL) &&
+			   (xmlStrEqual(cur->ns->prefix, tmp->ns->prefix)))))))
+                        occur++;
+                    tmp = tmp->next;
+                }
+                if (occur != 0)
+                    occur = 1;
+            } else
+                occur++;
+        } else if (cur->type == XML_COMMENT_NODE) {
+            xmlBufCat(buf, BAD_CAST "/comment()");
+
+            /*
+             * Thumbler index computation
+             */
+            tmp = cur->prev;
+            while (tmp != NULL) {
+                if (tmp->type == XML_COMMENT_NODE)
+		    occur++;
+                tmp = tmp->prev;
+            }
+            if (occur == 0) {
+                tmp = cur->next;
+                while (tmp != NULL && occur == 0) {
+		    if (tmp->type == XML_COMMENT_NODE)
+		        occur++;
+                    tmp = tmp->next;
+                }
+                if (occur != 0)
+                    occur = 1;
+            } else
+                occur++;
+        } else if ((cur->type == XML_TEXT_NODE) ||
+                   (cur->type == XML_CDATA_SECTION_NODE)) {
+            xmlBufCat(buf, BAD_CAST "/text()");
+
+            /*
+             * Thumbler index computation
+             */
+            tmp = cur->prev;
+            while (tmp != NULL) {
+                if ((tmp->type == XML_TEXT_NODE) ||
+		    (tmp->type == XML_CDATA_SECTION_NODE))
+		    occur++;
+                tmp = tmp->prev;
+            }
+	    /*
+	    * Evaluate if this is the only text- or CDATA-section-node;
+	    * if yes, then we'll get "text()", otherwise "text()[1]".
+	    */
+            if (occur == 0) {
+                tmp = cur->next;
+                while (tmp != NULL) {
+		    if ((tmp->type == XML_TEXT_NODE) ||
+			(tmp->type == XML_CDATA_SECTION_NODE))
+		    {
+			occur = 1;
+			break;
+		    }
+		    tmp = tmp->next;
+		}
+            } else
+                occur++;
+        } else if (cur->type == XML_PI_NODE) {
+            xmlBufCat(buf, BAD_CAST "/processing-instruction('");
+            xmlBufCat(buf, cur->name);
+            xmlBufCat(buf, BAD_CAST "')");
+
+            /*
+             * Thumbler index computation
+             */
+            tmp = cur->prev;
+            while (tmp != NULL) {
+                if ((tmp->type == XML_PI_NODE) &&
+		    (xmlStrEqual(cur->name, tmp->name)))
+                    occur++;
+                tmp = tmp->prev;
+            }
+            if (occur == 0) {
+                tmp = cur->next;
+                while (tmp != NULL && occur == 0) {
+                    if ((tmp->type == XML_PI_NODE) &&
+			(xmlStrEqual(cur->name, tmp->name)))
+                        occur++;
+                    tmp = tmp->next;
+                }
+                if (occur != 0)
+                    occur = 1;
+            } else
+                occur++;
+
+        } else if (cur->type == XML_ATTRIBUTE_NODE) {
+            xmlBufCat(buf, BAD_CAST "/@");
+            if (cur->ns && cur->ns->prefix != NULL) {
+                xmlBufCat(buf, cur->ns->prefix);
+                xmlBufCat(buf, BAD_CAST ":");
+            }
+            xmlBufCat(buf, cur->name);
+        } else {
+            goto error;
+        }
+
+        if (occur > 0) {
+            char tmpbuf[30];
+
+            snprintf(tmpbuf, sizeof(tmpbuf), "[%d]", occur);
+            xmlBufCat(buf, BAD_CAST tmpbuf);
+        }
+    }
+
+    ret = xmlBufDetach(buf);
+
+error:
+    xmlBufFree(buf);
+    xmlFree(nodes);
+    return(ret);
 }
 
 /**
- * Set (or reset) an element's attribute. If `name` has a prefix,
- * the corresponding namespace will be used. It is an error if
- * there's no such binding for the prefix in scope.
+ * Get the root element of the document.
  *
- * @param node  the node
- * @param name  the attribute name (a QName)
- * @param value  the attribute value
- * @returns the attribute pointer.
+ * Searches the document's children for the root element. The first
+ * child is not necessarily the root element, but could also be a
+ * DTD, comment or PI.
+ *
+ * @param doc  the document
+ * @returns the root element or NULL if no element was found.
  */
-xmlAttr *
-xmlSetProp(xmlNode *node, const xmlChar *name, const xmlChar *value) {
-    xmlNsPtr ns = NULL;
-    const xmlChar *localname;
-    xmlChar *prefix;
-    int res;
-
-    if ((node == NULL) || (name == NULL) || (node->type != XML_ELEMENT_NODE))
-	return(NULL);
-
-    /*
-     * handle QNames
-     */
-    localname = xmlSplitQName4(name, &prefix);
-    if (localname == NULL)
-        return(NULL);
+xmlNode *
+xmlDocGetRootElement(const xmlDoc *doc) {
+    xmlNodePtr ret;
 
-    if (prefix != NULL) {
-	res = xmlSearchNsSafe(node, prefix, &ns);
-	xmlFree(prefix);
-        if (res < 0)
-            return(NULL);
-        if (ns != NULL)
-            return(xmlSetNsProp(node, ns, localname, value));
+    if (doc == NULL) return(NULL);
+    ret = doc->children;
+    while (ret != NULL) {
+	if (ret->type == XML_ELEMENT_NODE)
+	    return(ret);
+        ret = ret->next;
     }
-
-    return(xmlSetNsProp(node, NULL, name, value));
+    return(ret);
 }
 
 /**
- * Set (or reset) an element's attribute.
+ * If `root` is NULL no action is taken. To remove a node from a
+ * document, use #xmlUnlinkNode instead.
  *
- * The namespace must be in scope.
+ * Set the root element of the document (`doc->children` is a list
+ * containing possibly comments, PIs, etc ...).
  *
- * @param node  the node
- * @param ns  the namespace definition
- * @param name  the attribute name
- * @param value  the attribute value
- * @returns the attribute pointer.
+ * `root` must be an element node. It is unlinked before insertion.
+ *
+ * @param doc  the document
+ * @param root  the new document root element
+ * @returns the unlinked old root element or NULL if the document
+ * didn't have a root element or a memory allocation failed.
  */
-xmlAttr *
-xmlSetNsProp(xmlNode *node, xmlNs *ns, const xmlChar *name,
-	     const xmlChar *value)
-{
-    xmlAttrPtr prop;
+xmlNode *
+xmlDocSetRootElement(xmlDoc *doc, xmlNode *root) {
+    xmlNodePtr old = NULL;
 
-    if (ns && (ns->href == NULL))
+    if (doc == NULL) return(NULL);
+    if ((root == NULL) || (root->type == XML_NAMESPACE_DECL))
 	return(NULL);
-    if (name == NULL)
-        return(NULL);
-    prop = xmlGetPropNodeInternal(node, name,
-                                  (ns != NULL) ? ns->href : NULL, 0);
-    if (prop != NULL) {
-        xmlNodePtr children = NULL;
-
-	/*
-	* Modify the attribute's value.
-	*/
-        if (value != NULL) {
-	    children = xmlNewDocText(node->doc, value);
-            if (children == NULL)
-                return(NULL);
-        }
-
-	if (prop->id != NULL) {
-	    xmlRemoveID(node->doc, prop);
-	    prop->atype = XML_ATTRIBUTE_ID;
-	}
-	if (prop->children != NULL)
-	    xmlFreeNodeList(prop->children);
-	prop->children = NULL;
-	prop->last = NULL;
-	prop->ns = ns;
-	if (value != NULL) {
-	    xmlNodePtr tmp;
-
-	    prop->children = children;
-	    prop->last = NULL;
-	    tmp = prop->children;
-	    while (tmp != NULL) {
-		tmp->parent = (xmlNodePtr) prop;
-		if (tmp->next == NULL)
-		    prop->last = tmp;
-		tmp = tmp->next;
-	    }
+    old = doc->children;
+    while (old != NULL) {
+	if (old->type == XML_ELEMENT_NODE)
+	    break;
+        old = old->next;
+    }
+    if (old == root)
+        return(old);
+    if (!xmlTreeCanMove(root, doc))
+        return(NULL);
+    xmlUnlinkNodeInternal(root);
+    if (xmlSetTreeDocInternal(root, doc) < 0)
+        return(NULL);
+    xmlDocIndexInvalidate(doc);
+    root->parent = (xmlNodePtr) doc;
+    if (old == NULL) {
+	if (doc->children == NULL) {
+	    doc->children = root;
+	    doc->last = root;
+	} else {
+	    xmlAddSibling(doc->children, root);
 	}
-	if ((prop->atype == XML_ATTRIBUTE_ID) &&
-	    (xmlAddIDSafe(prop, value) < 0)) {
-            return(NULL);
-        }
-	return(prop);
+    } else {
+	xmlReplaceNode(old, root);
     }
-    /*
-    * No equal attr found; create a new one.
-    */
-    return(xmlNewPropInternal(node, ns, name, value, 0));
+    return(old);
 }
 
 /**
- * Check whether the node is a text node.
+ * Set the `xml:lang` attribute of a node.
  *
- * @param node  the node
- * @returns 1 if yes, 0 if no
+ * @param cur  the node being changed
+ * @param lang  the language description
+ * @returns 0 on success, 1 if arguments are invalid, -1 if a
+ * memory allocation failed.
  */
 int
-xmlNodeIsText(const xmlNode *node) {
-    if (node == NULL) return(0);
+xmlNodeSetLang(xmlNode *cur, const xmlChar *lang) {
+    xmlNsPtr ns;
+    xmlAttrPtr attr;
+    int res;
+
+    if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
+        return(1);
+
+    res = xmlSearchNsByHrefSafe(cur, XML_XML_NAMESPACE, &ns);
+    if (res != 0)
+        return(res);
+    attr = xmlSetNsProp(cur, ns, BAD_CAST "lang", lang);
+    if (attr == NULL)
+        return(-1);
 
-    if (node->type == XML_TEXT_NODE) return(1);
     return(0);
 }
 
 /**
- * Checks whether this node is an empty or whitespace-only
- * text node.
+ * Find the `xml:lang` of a node.
  *
- * @param node  the node
- * @returns 1 if yes, 0 if no
+ * Look up the value of the `xml:lang` attribute or the one carried
+ * by the nearest ancestor.
+ *
+ * @param cur  the node being checked
+ * @returns a pointer to the lang value, or NULL if not found
+ *     It's up to the caller to free the memory with #xmlFree.
  */
-int
-xmlIsBlankNode(const xmlNode *node) {
-    const xmlChar *cur;
-    if (node == NULL) return(0);
+xmlChar *
+xmlNodeGetLang(const xmlNode *cur) {
+    xmlChar *lang;
+    int res;
 
-    if ((node->type != XML_TEXT_NODE) &&
-        (node->type != XML_CDATA_SECTION_NODE))
-	return(0);
-    if (node->content == NULL) return(1);
-    cur = node->content;
-    while (*cur != 0) {
-	if (!IS_BLANK_CH(*cur)) return(0);
-	cur++;
+    if ((cur == NULL) || (cur->type == XML_NAMESPACE_DECL))
+        return(NULL);
+
+    while (cur != NULL) {
+        res = xmlNodeGetAttrValue(cur, BAD_CAST "lang", XML_XML_NAMESPACE,
+                                  &lang);
+        if (res < 0)
+            return(NULL);
+	if (lang != NULL)
+	    return(lang);
+
+	cur = cur->parent;
     }
 
-    return(1);
+    return(NULL);
 }
 
+
 /**
- * Concat the given string at the end of the existing node content.
- *
- * If `len` is -1, the string length will be calculated.
+ * Set the `xml:space` attribute of a node.
  *
- * @param node  the node
- * @param content  the content
- * @param len  `content` length
- * @returns -1 in case of error, 0 otherwise
+ * @param cur  the node being changed
+ * @param val  the xml:space value ("0": default, 1: "preserve")
+ * @returns 0 on success, 1 if arguments are invalid, -1 if a
+ * memory allocation failed.
  */
-
 int
-xmlTextConcat(xmlNode *node, const xmlChar *content, int len) {
-    if (node == NULL)
-        return(-1);
+xmlNodeSetSpacePreserve(xmlNode *cur, int val) {
+    xmlNsPtr ns;
+    xmlAttrPtr attr;
+    const char *string;
+    int res;
 
-    if ((node->type != XML_TEXT_NODE) &&
-        (node->type != XML_CDATA_SECTION_NODE) &&
-	(node->type != XML_COMMENT_NODE) &&
-	(node->type != XML_PI_NODE))
-        return(-1);
+    if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
+        return(1);
 
-    return(xmlTextAddContent(node, content, len));
-}
+    res = xmlSearchNsByHrefSafe(cur, XML_XML_NAMESPACE, &ns);
+    if (res != 0)
+	return(res);
 
-/**
- * Get the compression level of a document, ZLIB based.
- *
- * @param doc  the document
- * @returns 0 (uncompressed) to 9 (max compression)
- */
-int
-xmlGetDocCompressMode (const xmlDoc *doc) {
-    if (doc == NULL) return(-1);
-    return(doc->compression);
-}
+    if (val == 0)
+        string = "default";
+    else
+        string = "preserve";
 
-/**
- * Set the compression level of a document, ZLIB based.
- *
- * Correct values: 0 (uncompressed) to 9 (max compression)
- *
- * @param doc  the document
- * @param mode  the compression ratio
- */
-void
-xmlSetDocCompressMode (xmlDoc *doc, int mode) {
-    if (doc == NULL) return;
-    if (mode < 0) doc->compression = 0;
-    else if (mode > 9) doc->compression = 9;
-    else doc->compression = mode;
+    attr = xmlSetNsProp(cur, ns, BAD_CAST "space", BAD_CAST string);
+    if (attr == NULL)
+        return(-1);
+
+    return(0);
 }
 
 /**
- * Get the global compression level, ZLIB based.
+ * Find the `xml:space` of a node.
  *
- * @deprecated Use #xmlGetDocCompressMode
+ * Look up the value of the `xml:space` attribute or the one carried
+ * by the nearest ancestor.
  *
- * @returns 0 (uncompressed) to 9 (max compression)
+ * @param cur  the node being checked
+ * @returns -1 if xml:space is not inherited, 0 if "default", 1 if "preserve"
  */
 int
-xmlGetCompressMode(void)
-{
-    return (xmlCompressMode);
+xmlNodeGetSpacePreserve(const xmlNode *cur) {
+    xmlChar *space;
+        int res;
+
+    if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
+        return(-1);
+
+    while (cur != NULL) {
+	res = xmlNodeGetAttrValue(cur, BAD_CAST "space", XML_XML_NAMESPACE,
+                                  &space);
+        if (res < 0)
+            return(-1);
+	if (space != NULL) {
+	    if (xmlStrEqual(space, BAD_CAST "preserve")) {
+		xmlFree(space);
+		return(1);
+	    }
+	    if (xmlStrEqual(space, BAD_CAST "default")) {
+		xmlFree(space);
+		return(0);
+	    }
+	    xmlFree(space);
+	}
+
+	cur = cur->parent;
+    }
+
+    return(-1);
 }
 
 /**
- * Set the global compression level, ZLIB based.
- *
- * @deprecated Use #xmlSetDocCompressMode
- *
- * Correct values: 0 (uncompressed) to 9 (max compression)
+ * Set (or reset) the name of a node.
  *
- * @param mode  the compression ratio
+ * @param cur  the node being changed
+ * @param name  the new tag name
  */
 void
-xmlSetCompressMode(int mode) {
-    if (mode < 0) xmlCompressMode = 0;
-    else if (mode > 9) xmlCompressMode = 9;
-    else xmlCompressMode = mode;
-}
+xmlNodeSetName(xmlNode *cur, const xmlChar *name) {
+    xmlDocPtr doc;
+    xmlDictPtr dict;
+    const xmlChar *copy;
+    const xmlChar *oldName;
 
-#define XML_TREE_NSMAP_PARENT -1
-#define XML_TREE_NSMAP_XML -2
-#define XML_TREE_NSMAP_DOC -3
-#define XML_TREE_NSMAP_CUSTOM -4
-
-typedef struct xmlNsMapItem *xmlNsMapItemPtr;
-struct xmlNsMapItem {
-    xmlNsMapItemPtr next;
-    xmlNsMapItemPtr prev;
-    xmlNsPtr oldNs; /* old ns decl reference */
-    xmlNsPtr newNs; /* new ns decl reference */
-    int shadowDepth; /* Shadowed at this depth */
-    /*
-    * depth:
-    * >= 0 == @node's ns-decls
-    * -1   == @parent's ns-decls
-    * -2   == the doc->oldNs XML ns-decl
-    * -3   == the doc->oldNs storage ns-decls
-    * -4   == ns-decls provided via custom ns-handling
-    */
-    int depth;
-};
-
-typedef struct xmlNsMap *xmlNsMapPtr;
-struct xmlNsMap {
-    xmlNsMapItemPtr first;
-    xmlNsMapItemPtr last;
-    xmlNsMapItemPtr pool;
-};
+    if (cur == NULL) return;
+    if (name == NULL) return;
+    switch(cur->type) {
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+        case XML_PI_NODE:
+        case XML_ENTITY_REF_NODE:
+	    break;
+        default:
+            return;
+    }
 
-#define XML_NSMAP_NOTEMPTY(m) (((m) != NULL) && ((m)->first != NULL))
-#define XML_NSMAP_FOREACH(m, i) for (i = (m)->first; i != NULL; i = (i)->next)
-#define XML_NSMAP_POP(m, i) \
-    i = (m)->last; \
-    (m)->last = (i)->prev; \
-    if ((m)->last == NULL) \
-	(m)->first = NULL; \
-    else \
-	(m)->last->next = NULL; \
-    (i)->next = (m)->pool; \
-    (m)->pool = i;
+    doc = cur->doc;
+    if (doc != NULL)
+	dict = doc->dict;
+    else
+        dict = NULL;
 
-/**
- * Frees the ns-map
- *
- * @param nsmap  the ns-map
- */
-static void
-xmlDOMWrapNsMapFree(xmlNsMapPtr nsmap)
-{
-    xmlNsMapItemPtr cur, tmp;
+    if (dict != NULL)
+        copy = xmlDictLookup(dict, name, -1);
+    else
+        copy = xmlStrdup(name);
+    if (copy == NULL)
+        return;
 
-    if (nsmap == NULL)
-	return;
-    cur = nsmap->pool;
-    while (cur != NULL) {
-	tmp = cur;
-	cur = cur->next;
-	xmlFree(tmp);
-    }
-    cur = nsmap->first;
-    while (cur != NULL) {
-	tmp = cur;
-	cur = cur->next;
-	xmlFree(tmp);
-    }
-    xmlFree(nsmap);
+    oldName = cur->name;
+    cur->name = copy;
+    xmlNodeSourceChanged(cur);
+    if (cur->type == XML_ELEMENT_NODE)
+        xmlDocIndexInvalidate(doc);
+    else
+        xmlDocIndexAttrChanged(cur);
+    if ((oldName != NULL) &&
+        ((dict == NULL) || (!xmlDictOwns(dict, oldName))))
+        xmlFree((xmlChar *) oldName);
 }
 
 /**
- * Adds an ns-mapping item.
+ * Set (or reset) the base URI of a node, i.e. the value of the
+ * `xml:base` attribute.
  *
- * @param nsmap  the ns-map
- * @param position  position
- * @param oldNs  the old ns-struct
- * @param newNs  the new ns-struct
- * @param depth  depth and ns-kind information
- * @returns the added item.
+ * @param cur  the node being changed
+ * @param uri  the new base URI
+ * @returns 0 on success, -1 on error.
  */
-static xmlNsMapItemPtr
-xmlDOMWrapNsMapAddItem(xmlNsMapPtr *nsmap, int position,
-		       xmlNsPtr oldNs, xmlNsPtr newNs, int depth)
-{
-    xmlNsMapItemPtr ret;
-    xmlNsMapPtr map;
-
-    if (nsmap == NULL)
-	return(NULL);
-    if ((position != -1) && (position != 0))
-	return(NULL);
-    map = *nsmap;
+int
+xmlNodeSetBase(xmlNode *cur, const xmlChar* uri) {
+    xmlNsPtr ns;
+    xmlChar* fixed;
 
-    if (map == NULL) {
-	/*
-	* Create the ns-map.
-	*/
-	map = (xmlNsMapPtr) xmlMalloc(sizeof(struct xmlNsMap));
-	if (map == NULL)
-	    return(NULL);
-	memset(map, 0, sizeof(struct xmlNsMap));
-	*nsmap = map;
-    }
+    if (cur == NULL)
+        return(-1);
+    switch(cur->type) {
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+	    break;
+        case XML_DOCUMENT_NODE:
+        case XML_HTML_DOCUMENT_NODE: {
+	    xmlDocPtr doc = (xmlDocPtr) cur;
 
-    if (map->pool != NULL) {
-	/*
-	* Reuse an item from the pool.
-	*/
-	ret = map->pool;
-	map->pool = ret->next;
-	memset(ret, 0, sizeof(struct xmlNsMapItem));
-    } else {
-	/*
-	* Create a new item.
-	*/
-	ret = (xmlNsMapItemPtr) xmlMalloc(sizeof(struct xmlNsMapItem));
-	if (ret == NULL)
-	    return(NULL);
-	memset(ret, 0, sizeof(struct xmlNsMapItem));
+	    if (doc->URL != NULL)
+		xmlFree(doc->URL);
+	    if (uri == NULL) {
+		doc->URL = NULL;
+            } else {
+		doc->URL = xmlPathToURI(uri);
+                if (doc->URL == NULL)
+                    return(-1);
+            }
+	    return(0);
+	}
+        default:
+	    return(-1);
     }
 
-    if (map->first == NULL) {
-	/*
-	* First ever.
-	*/
-	map->first = ret;
-	map->last = ret;
-    } else if (position == -1) {
-	/*
-	* Append.
-	*/
-	ret->prev = map->last;
-	map->last->next = ret;
-	map->last = ret;
-    } else if (position == 0) {
-	/*
-	* Set on first position.
-	*/
-	map->first->prev = ret;
-	ret->next = map->first;
-	map->first = ret;
+    xmlSearchNsByHrefSafe(cur, XML_XML_NAMESPACE, &ns);
+    if (ns == NULL)
+	return(-1);
+    fixed = xmlPathToURI(uri);
+    if (fixed == NULL)
+        return(-1);
+    if (xmlSetNsProp(cur, ns, BAD_CAST "base", fixed) == NULL) {
+        xmlFree(fixed);
+        return(-1);
     }
+    xmlFree(fixed);
 
-    ret->oldNs = oldNs;
-    ret->newNs = newNs;
-    ret->shadowDepth = -1;
-    ret->depth = depth;
-    return (ret);
+    return(0);
 }
 
 /**
- * Creates or reuses an xmlNs struct on doc->oldNs with
- * the given prefix and namespace name.
+ * Searches for the base URI. The code should work on both XML
+ * and HTML document even if base mechanisms are completely different.
+ * It returns the base as defined in RFC 2396 sections "5.1.1. Base
+ * URI within Document Content" and "5.1.2. Base URI from the
+ * Encapsulating Entity". However it does not return the document base
+ * (5.1.3), use `doc->URL` in this case.
  *
- * @param doc  the doc
- * @param nsName  the namespace name
- * @param prefix  the prefix
- * @returns the acquired ns struct or NULL in case of an API
- *          or internal error.
+ * @since 2.13.0
+ *
+ * @param doc  the document the node pertains to
+ * @param cur  the node being checked
+ * @param baseOut  pointer to base
+ * @returns 0 in case of success, 1 if a URI or argument is invalid, -1 if a
+ * memory allocation failed.
  */
-static xmlNsPtr
-xmlDOMWrapStoreNs(xmlDocPtr doc,
-		   const xmlChar *nsName,
-		   const xmlChar *prefix)
-{
-    xmlNsPtr ns;
+int
+xmlNodeGetBaseSafe(const xmlDoc *doc, const xmlNode *cur, xmlChar **baseOut) {
+    xmlChar *ret = NULL;
+    xmlChar *base, *newbase;
+    int res;
 
+    if (baseOut == NULL)
+        return(1);
+    *baseOut = NULL;
+    if ((cur == NULL) && (doc == NULL))
+        return(1);
+    if ((cur != NULL) && (cur->type == XML_NAMESPACE_DECL))
+        return(1);
     if (doc == NULL)
-	return (NULL);
-    ns = xmlTreeEnsureXMLDecl(doc);
-    if (ns == NULL)
-	return (NULL);
-    if (ns->next != NULL) {
-	/* Reuse. */
-	ns = ns->next;
-	while (ns != NULL) {
-	    if (((ns->prefix == prefix) ||
-		xmlStrEqual(ns->prefix, prefix)) &&
-		xmlStrEqual(ns->href, nsName)) {
-		return (ns);
-	    }
-	    if (ns->next == NULL)
-		break;
-	    ns = ns->next;
-	}
-    }
-    /* Create. */
-    if (ns != NULL) {
-        ns->next = xmlNewNs(NULL, nsName, prefix);
-        return (ns->next);
-    }
-    return(NULL);
-}
+        doc = cur->doc;
 
-/**
- * Allocates and initializes a new DOM-wrapper context.
- *
- * @returns the xmlDOMWrapCtxt or NULL in case of an internal error.
- */
-xmlDOMWrapCtxt *
-xmlDOMWrapNewCtxt(void)
-{
-    xmlDOMWrapCtxtPtr ret;
-
-    ret = xmlMalloc(sizeof(xmlDOMWrapCtxt));
-    if (ret == NULL)
-	return (NULL);
-    memset(ret, 0, sizeof(xmlDOMWrapCtxt));
-    return (ret);
-}
-
-/**
- * Frees the DOM-wrapper context.
- *
- * @param ctxt  the DOM-wrapper context
- */
-void
-xmlDOMWrapFreeCtxt(xmlDOMWrapCtxt *ctxt)
-{
-    if (ctxt == NULL)
-	return;
-    if (ctxt->namespaceMap != NULL)
-	xmlDOMWrapNsMapFree((xmlNsMapPtr) ctxt->namespaceMap);
-    /*
-    * TODO: Store the namespace map in the context.
-    */
-    xmlFree(ctxt);
-}
-
-/**
- * Searches for a ns-decl with the given prefix in `nsList`.
- *
- * @param nsList  a list of ns-structs
- * @param prefix  the searched prefix
- * @returns the ns-decl if found, NULL if not found and on
- *          API errors.
- */
-static xmlNsPtr
-xmlTreeNSListLookupByPrefix(xmlNsPtr nsList, const xmlChar *prefix)
-{
-    if (nsList == NULL)
-	return (NULL);
-    {
-	xmlNsPtr ns;
-	ns = nsList;
-	do {
-	    if ((prefix == ns->prefix) ||
-		xmlStrEqual(prefix, ns->prefix)) {
-		return (ns);
+    if ((doc != NULL) && (doc->type == XML_HTML_DOCUMENT_NODE)) {
+        cur = doc->children;
+	while ((cur != NULL) && (cur->name != NULL)) {
+	    if (cur->type != XML_ELEMENT_NODE) {
+	        cur = cur->next;
+		continue;
 	    }
-	    ns = ns->next;
-	} while (ns != NULL);
+	    if (!xmlStrcasecmp(cur->name, BAD_CAST "html")) {
+	        cur = cur->children;
+		continue;
+	    }
+	    if (!xmlStrcasecmp(cur->name, BAD_CAST "head")) {
+	        cur = cur->children;
+		continue;
+	    }
+	    if (!xmlStrcasecmp(cur->name, BAD_CAST "base")) {
+                if (xmlNodeGetAttrValue(cur, BAD_CAST "href", NULL, &ret) < 0)
+                    return(-1);
+                if (ret == NULL)
+                    return(1);
+                goto found;
+	    }
+	    cur = cur->next;
+	}
+	return(0);
     }
-    return (NULL);
-}
 
-/**
- * Puts in-scope namespaces into the ns-map.
- *
- * @param map  the namespace map
- * @param node  the node to start with
- * @returns 0 on success, -1 on API or internal errors.
- */
-static int
-xmlDOMWrapNSNormGatherInScopeNs(xmlNsMapPtr *map,
-				xmlNodePtr node)
-{
-    xmlNodePtr cur;
-    xmlNsPtr ns;
-    xmlNsMapItemPtr mi;
-    int shadowed;
+    while (cur != NULL) {
+	if (cur->type == XML_ENTITY_DECL) {
+	    xmlEntityPtr ent = (xmlEntityPtr) cur;
 
-    if ((map == NULL) || (*map != NULL))
-	return (-1);
-    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
-        return (-1);
-    /*
-    * Get in-scope ns-decls of @parent.
-    */
-    cur = node;
-    while ((cur != NULL) && (cur != (xmlNodePtr) cur->doc)) {
+            if (ent->URI == NULL)
+                break;
+            xmlFree(ret);
+	    ret = xmlStrdup(ent->URI);
+            if (ret == NULL)
+                return(-1);
+            goto found;
+	}
 	if (cur->type == XML_ELEMENT_NODE) {
-	    if (cur->nsDef != NULL) {
-		ns = cur->nsDef;
-		do {
-		    shadowed = 0;
-		    if (XML_NSMAP_NOTEMPTY(*map)) {
-			/*
-			* Skip shadowed prefixes.
-			*/
-			XML_NSMAP_FOREACH(*map, mi) {
-			    if ((ns->prefix == mi->newNs->prefix) ||
-				xmlStrEqual(ns->prefix, mi->newNs->prefix)) {
-				shadowed = 1;
-				break;
-			    }
-			}
-		    }
-		    /*
-		    * Insert mapping.
-		    */
-		    mi = xmlDOMWrapNsMapAddItem(map, 0, NULL,
-			ns, XML_TREE_NSMAP_PARENT);
-		    if (mi == NULL)
-			return (-1);
-		    if (shadowed)
-			mi->shadowDepth = 0;
-		    ns = ns->next;
-		} while (ns != NULL);
+	    if (xmlNodeGetAttrValue(cur, BAD_CAST "base", XML_XML_NAMESPACE,
+                                    &base) < 0) {
+                xmlFree(ret);
+                return(-1);
+            }
+	    if (base != NULL) {
+		if (ret != NULL) {
+		    res = xmlBuildURISafe(ret, base, &newbase);
+                    xmlFree(ret);
+                    xmlFree(base);
+                    if (res != 0)
+                        return(res);
+		    ret = newbase;
+		} else {
+		    ret = base;
+		}
+		if ((!xmlStrncmp(ret, BAD_CAST "http://", 7)) ||
+		    (!xmlStrncmp(ret, BAD_CAST "ftp://", 6)) ||
+		    (!xmlStrncmp(ret, BAD_CAST "urn:", 4)))
+                    goto found;
 	    }
 	}
 	cur = cur->parent;
     }
-    return (0);
+
+    if ((doc != NULL) && (doc->URL != NULL)) {
+	if (ret == NULL) {
+	    ret = xmlStrdup(doc->URL);
+            if (ret == NULL)
+                return(-1);
+        } else {
+            res = xmlBuildURISafe(ret, doc->URL, &newbase);
+            xmlFree(ret);
+            if (res != 0)
+                return(res);
+            ret = newbase;
+        }
+    }
+
+found:
+    *baseOut = ret;
+    return(0);
 }
 
-/*
- * For internal use. Adds a ns-decl mapping.
+/**
+ * See #xmlNodeGetBaseSafe. This function doesn't allow to distinguish
+ * memory allocation failures from a non-existing base.
  *
- * Returns 0 on success, -1 on internal errors.
+ * @param doc  the document the node pertains to
+ * @param cur  the node being checked
+ * @returns a pointer to the base URL, or NULL if not found
+ *     It's up to the caller to free the memory with #xmlFree.
  */
-static int
-xmlDOMWrapNSNormAddNsMapItem2(xmlNsPtr **list, int *size, int *number,
-			xmlNsPtr oldNs, xmlNsPtr newNs)
-{
-    if (*number >= *size) {
-        xmlNsPtr *tmp;
-        int newSize;
-
-        newSize = xmlGrowCapacity(*size, 2 * sizeof(tmp[0]), 3, XML_MAX_ITEMS);
-        if (newSize < 0)
-            return(-1);
-        tmp = xmlRealloc(*list, newSize * 2 * sizeof(tmp[0]));
-        if (tmp == NULL)
-            return(-1);
-        *list = tmp;
-        *size = newSize;
-    }
+xmlChar *
+xmlNodeGetBase(const xmlDoc *doc, const xmlNode *cur) {
+    xmlChar *base;
 
-    (*list)[2 * (*number)] = oldNs;
-    (*list)[2 * (*number) +1] = newNs;
-    (*number)++;
-    return (0);
+    xmlNodeGetBaseSafe(doc, cur, &base);
+    return(base);
 }
 
 /**
- * Unlinks the given node from its owner.
- *
- * This will substitute ns-references to node->nsDef for
- * ns-references to doc->oldNs, thus ensuring the removed
- * branch to be autark wrt ns-references.
+ * Append the string value of a node to `buffer`. For text nodes,
+ * the string value is the text content. Otherwise, the string value
+ * is the concatenation of the string values of the node's
+ * descendants.
  *
- * NOTE: This function was not intensively tested.
+ * Entity references are substituted.
  *
- * @param ctxt  a DOM wrapper context
- * @param doc  the doc
- * @param node  the node to be removed.
- * @param options  set of options, unused at the moment
- * @returns 0 on success, 1 if the node is not supported,
- *          -1 on API and internal errors.
+ * @param buffer  a buffer
+ * @param cur  the node being read
+ * @returns 0 in case of success and -1 in case of error.
  */
 int
-xmlDOMWrapRemoveNode(xmlDOMWrapCtxt *ctxt, xmlDoc *doc,
-		     xmlNode *node, int options ATTRIBUTE_UNUSED)
+xmlNodeBufGetContent(xmlBuffer *buffer, const xmlNode *cur)
 {
-    xmlNsPtr *list = NULL;
-    int sizeList = 0, nbList = 0, ret = 0, i, j;
-    xmlNsPtr ns;
+    xmlBufPtr buf;
+    int ret1, ret2;
 
-    if ((node == NULL) || (doc == NULL) || (node->doc != doc))
-	return (-1);
+    if ((cur == NULL) || (buffer == NULL)) return(-1);
+    buf = xmlBufFromBuffer(buffer);
+    ret1 = xmlBufGetNodeContent(buf, cur);
+    ret2 = xmlBufBackToBuffer(buf, buffer);
+    if ((ret1 < 0) || (ret2 < 0))
+        return(-1);
+    return(0);
+}
 
-    /* TODO: 0 or -1 ? */
-    if (node->parent == NULL)
-	return (0);
+static int
+xmlNodeWalkText(const xmlChar *text, xmlNodeContentFunc func, void *ctxt) {
+    int len;
 
-    switch (node->type) {
-	case XML_TEXT_NODE:
-	case XML_CDATA_SECTION_NODE:
-	case XML_ENTITY_REF_NODE:
-	case XML_PI_NODE:
-	case XML_COMMENT_NODE:
-	    xmlUnlinkNodeInternal(node);
-	    return (0);
-	case XML_ELEMENT_NODE:
-	case XML_ATTRIBUTE_NODE:
-	    break;
-	default:
-	    return (1);
+    if (text == NULL)
+        return(0);
+    len = xmlStrlen(text);
+    if (len == 0)
+        return(0);
+    return(func(ctxt, text, len));
+}
+
+static int
+xmlNodeWalkEntityRef(const xmlNode *ref, xmlNodeContentFunc func,
+                     void *ctxt) {
+    xmlEntityPtr ent;
+    int ret;
+
+    if (ref->children != NULL) {
+        ent = (xmlEntityPtr) ref->children;
+    } else {
+        /* lookup entity declaration */
+        ent = xmlGetDocEntity(ref->doc, ref->name);
+        if (ent == NULL)
+            return(0);
     }
-    xmlUnlinkNodeInternal(node);
+
     /*
-    * Save out-of-scope ns-references in doc->oldNs.
-    */
-    do {
-	switch (node->type) {
-	    case XML_ELEMENT_NODE:
-		if ((ctxt == NULL) && (node->nsDef != NULL)) {
-		    ns = node->nsDef;
-		    do {
-			if (xmlDOMWrapNSNormAddNsMapItem2(&list, &sizeList,
-			    &nbList, ns, ns) == -1)
-			    ret = -1;
-			ns = ns->next;
-		    } while (ns != NULL);
-		}
-                /* Falls through. */
-	    case XML_ATTRIBUTE_NODE:
-		if (node->ns != NULL) {
-		    /*
-		    * Find a mapping.
-		    */
-		    if (list != NULL) {
-			for (i = 0, j = 0; i < nbList; i++, j += 2) {
-			    if (node->ns == list[j]) {
-				node->ns = list[++j];
-				goto next_node;
-			    }
-			}
-		    }
-		    ns = NULL;
-		    if (ctxt != NULL) {
-			/*
-			* User defined.
-			*/
-		    } else {
-			/*
-			* Add to doc's oldNs.
-			*/
-			ns = xmlDOMWrapStoreNs(doc, node->ns->href,
-			    node->ns->prefix);
-			if (ns == NULL)
-			    ret = -1;
-		    }
-		    if (ns != NULL) {
-			/*
-			* Add mapping.
-			*/
-			if (xmlDOMWrapNSNormAddNsMapItem2(&list, &sizeList,
-			    &nbList, node->ns, ns) == -1)
-			    ret = -1;
-		    }
-		    node->ns = ns;
-		}
-		if ((node->type == XML_ELEMENT_NODE) &&
-		    (node->properties != NULL)) {
-		    node = (xmlNodePtr) node->properties;
-		    continue;
-		}
-		break;
-	    default:
-		goto next_sibling;
-	}
-next_node:
-	if ((node->type == XML_ELEMENT_NODE) &&
-	    (node->children != NULL)) {
-	    node = node->children;
-	    continue;
-	}
-next_sibling:
-	if (node == NULL)
-	    break;
-	if (node->next != NULL)
-	    node = node->next;
-	else {
-            int type = node->type;
+     * The parser should always expand predefined entities but it's
+     * possible to create references to predefined entities using
+     * the tree API.
+     */
+    if (ent->etype == XML_INTERNAL_PREDEFINED_ENTITY)
+        return(xmlNodeWalkText(ent->content, func, ctxt));
 
-	    node = node->parent;
-            if ((type == XML_ATTRIBUTE_NODE) &&
-                (node != NULL) &&
-                (node->children != NULL)) {
-                node = node->children;
-            } else {
-	        goto next_sibling;
-            }
-	}
-    } while (node != NULL);
+    if (ent->flags & XML_ENT_EXPANDING)
+        return(0);
 
-    if (list != NULL)
-	xmlFree(list);
-    return (ret);
+    /* Shared entities were checked for loops and are immutable */
+    if (ent->flags & XML_ENT_SHARED)
+        return(xmlNodeWalkChildren((xmlNodePtr) ent, func, ctxt));
+
+    ent->flags |= XML_ENT_EXPANDING;
+    ret = xmlNodeWalkChildren((xmlNodePtr) ent, func, ctxt);
+    ent->flags &= ~XML_ENT_EXPANDING;
+
+    return(ret);
 }
 
-/**
- * Dynamically searches for a ns-declaration which matches
- * the given `nsName` in the ancestor-or-self axis of `node`.
- *
- * @param doc  the document
- * @param node  the start node
- * @param nsName  the searched namespace name
- * @param retNs  the resulting ns-decl
- * @param prefixed  if the found ns-decl must have a prefix
- *                  (for attributes)
- * @returns 1 if a ns-decl was found, 0 if not and -1 on API
- *          and internal errors.
- */
 static int
-xmlSearchNsByNamespaceStrict(xmlDocPtr doc, xmlNodePtr node,
-			     const xmlChar* nsName,
-			     xmlNsPtr *retNs, int prefixed)
-{
-    xmlNodePtr cur, prev = NULL, out = NULL;
-    xmlNsPtr ns, prevns;
+xmlNodeWalkChildren(const xmlNode *tree, xmlNodeContentFunc func,
+                    void *ctxt) {
+    const xmlNode *cur = tree->children;
+    int ret = 0;
 
-    if ((doc == NULL) || (nsName == NULL) || (retNs == NULL))
-	return (-1);
-    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
-        return(-1);
+    while (cur != NULL) {
+        switch (cur->type) {
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+                ret = xmlNodeWalkText(cur->content, func, ctxt);
+                break;
 
-    *retNs = NULL;
-    if (xmlStrEqual(nsName, XML_XML_NAMESPACE)) {
-	*retNs = xmlTreeEnsureXMLDecl(doc);
-	if (*retNs == NULL)
-	    return (-1);
-	return (1);
+            case XML_ENTITY_REF_NODE:
+                ret = xmlNodeWalkEntityRef(cur, func, ctxt);
+                break;
+
+            default:
+                if (cur->children != NULL) {
+                    cur = cur->children;
+                    continue;
+                }
+                break;
+        }
+
+        if (ret != 0)
+            return(ret);
+
+        while (cur->next == NULL) {
+            cur = cur->parent;
+            if (cur == tree)
+                return(0);
+        }
+        cur = cur->next;
     }
-    cur = node;
-    do {
-	if (cur->type == XML_ELEMENT_NODE) {
-	    if (cur->nsDef != NULL) {
-		for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
-		    if (prefixed && (ns->prefix == NULL))
-			continue;
-		    if (prev != NULL) {
-			/*
-			* Check the last level of ns-decls for a
-			* shadowing prefix.
-			*/
-			prevns = prev->nsDef;
-			do {
-			    if ((prevns->prefix == ns->prefix) ||
-				((prevns->prefix != NULL) &&
-				(ns->prefix != NULL) &&
-				xmlStrEqual(prevns->prefix, ns->prefix))) {
-				/*
-				* Shadowed.
-				*/
-				break;
-			    }
-			    prevns = prevns->next;
-			} while (prevns != NULL);
-			if (prevns != NULL)
-			    continue;
-		    }
-		    /*
-		    * Ns-name comparison.
-		    */
-		    if ((nsName == ns->href) ||
-			xmlStrEqual(nsName, ns->href)) {
-			/*
-			* At this point the prefix can only be shadowed,
-			* if we are the the (at least) 3rd level of
-			* ns-decls.
-			*/
-			if (out) {
-			    int ret;
 
-			    ret = xmlNsInScope(doc, node, prev, ns->prefix);
-			    if (ret < 0)
-				return (-1);
-			    /*
-			    * TODO: Should we try to find a matching ns-name
-			    * only once? This here keeps on searching.
-			    * I think we should try further since, there might
-			    * be an other matching ns-decl with an unshadowed
-			    * prefix.
-			    */
-			    if (! ret)
-				continue;
-			}
-			*retNs = ns;
-			return (1);
-		    }
-		}
-		out = prev;
-		prev = cur;
-	    }
-	} else if (cur->type == XML_ENTITY_DECL)
-	    return (0);
-	cur = cur->parent;
-    } while ((cur != NULL) && (cur->doc != (xmlDocPtr) cur));
-    return (0);
+    return(0);
 }
 
 /**
- * Dynamically searches for a ns-declaration which matches
- * the given `nsName` in the ancestor-or-self axis of `node`.
+ * Walk the string value of a node without concatenating it. `func`
+ * is called for each non-empty text fragment in document order:
+ * text and CDATA content of descendants, the replacement text of
+ * entity references, or the node's own content for text, comment
+ * and PI nodes. Concatenating all fragments yields the same string
+ * as #xmlNodeGetContent.
  *
- * @param doc  the document
- * @param node  the start node
- * @param prefix  the searched namespace prefix
- * @param retNs  the resulting ns-decl
- * @returns 1 if a ns-decl was found, 0 if not and -1 on API
- *          and internal errors.
+ * Fragments point into the tree and are only valid during the
+ * callback. They are not null-terminated. The walk stops as soon
+ * as `func` returns a non-zero value.
+ *
+ * @since 2.16.0
+ *
+ * @param cur  the node being read
+ * @param func  the callback
+ * @param ctxt  user data passed to the callback
+ * @returns 0 if the walk completed, the value returned by `func` if
+ * it was stopped or -1 if arguments are invalid.
+ */
+int
+xmlNodeWalkContent(const xmlNode *cur, xmlNodeContentFunc func,
+                   void *ctxt) {
+    if ((cur == NULL) || (func == NULL))
+        return(-1);
+
+    switch (cur->type) {
+        case XML_DOCUMENT_NODE:
+        case XML_HTML_DOCUMENT_NODE:
+        case XML_DOCUMENT_FRAG_NODE:
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+        case XML_ENTITY_DECL:
+            return(xmlNodeWalkChildren(cur, func, ctxt));
+
+        case XML_CDATA_SECTION_NODE:
+        case XML_TEXT_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+            return(xmlNodeWalkText(cur->content, func, ctxt));
+
+        case XML_ENTITY_REF_NODE:
+            return(xmlNodeWalkEntityRef(cur, func, ctxt));
+
+        case XML_NAMESPACE_DECL:
+            return(xmlNodeWalkText(((xmlNsPtr) cur)->href, func, ctxt));
+
+        default:
+            break;
+    }
+
+    return(0);
+}
+
+/*
+ * Substituted content of a sibling list as returned by
+ * xmlNodeListGetString with entity substitution.
  */
 static int
-xmlSearchNsByPrefixStrict(xmlDocPtr doc, xmlNodePtr node,
-			  const xmlChar* prefix,
-			  xmlNsPtr *retNs)
-{
-    xmlNodePtr cur;
-    xmlNsPtr ns;
+xmlNodeListWalkContent(const xmlNode *node, xmlNodeContentFunc func,
+                       void *ctxt) {
+    int ret = 0;
 
-    if ((doc == NULL) || (node == NULL) || (node->type == XML_NAMESPACE_DECL))
+    while (node != NULL) {
+        if ((node->type == XML_TEXT_NODE) ||
+            (node->type == XML_CDATA_SECTION_NODE))
+            ret = xmlNodeWalkText(node->content, func, ctxt);
+        else if (node->type == XML_ENTITY_REF_NODE)
+            ret = xmlNodeWalkEntityRef(node, func, ctxt);
+        if (ret != 0)
+            return(ret);
+        node = node->next;
+    }
+
+    return(0);
+}
+
+#define XML_CONTENT_FRAGS_INLINE 32
+
+typedef struct {
+    const xmlChar *str;
+    int len;
+} xmlContentFrag;
+
+typedef struct {
+    xmlContentFrag *tab;
+    int nr;
+    int max;
+    size_t size;
+    xmlContentFrag inl[XML_CONTENT_FRAGS_INLINE];
+} xmlContentFrags;
+
+static int
+xmlContentCollect(void *ctxt, const xmlChar *content, int len) {
+    xmlContentFrags *frags = ctxt;
+
+    if (frags->size > SIZE_MAX - 1 - (size_t) len)
         return(-1);
 
-    if (retNs)
-	*retNs = NULL;
-    if (IS_STR_XML(prefix)) {
-	if (retNs) {
-	    *retNs = xmlTreeEnsureXMLDecl(doc);
-	    if (*retNs == NULL)
-		return (-1);
-	}
-	return (1);
+    if (frags->nr >= frags->max) {
+        xmlContentFrag *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(frags->max, sizeof(tmp[0]),
+                                  XML_CONTENT_FRAGS_INLINE, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        if (frags->tab == frags->inl) {
+            tmp = xmlMalloc(newSize * sizeof(tmp[0]));
+            if (tmp == NULL)
+                return(-1);
+            memcpy(tmp, frags->inl, frags->nr * sizeof(tmp[0]));
+        } else {
+            tmp = xmlRealloc(frags->tab, newSize * sizeof(tmp[0]));
+            if (tmp == NULL)
+                return(-1);
+        }
+        frags->tab = tmp;
+        frags->max = newSize;
     }
-    cur = node;
-    do {
-	if (cur->type == XML_ELEMENT_NODE) {
-	    if (cur->nsDef != NULL) {
-		ns = cur->nsDef;
-		do {
-		    if ((prefix == ns->prefix) ||
-			xmlStrEqual(prefix, ns->prefix))
-		    {
-			/*
-			* Disabled namespaces, e.g. xmlns:abc="".
-			*/
-			if (ns->href == NULL)
-			    return(0);
-			if (retNs)
-			    *retNs = ns;
-			return (1);
-		    }
-		    ns = ns->next;
-		} while (ns != NULL);
-	    }
-	} else if (cur->type == XML_ENTITY_DECL)
-	    return (0);
-	cur = cur->parent;
-    } while ((cur != NULL) && (cur->doc != (xmlDocPtr) cur));
-    return (0);
+
+    frags->tab[frags->nr].str = content;
+    frags->tab[frags->nr].len = len;
+    frags->nr++;
+    frags->size += len;
+    return(0);
+}
+
+/*
+ * Concatenate the string value in two passes: the first pass walks
+ * the tree and records the text fragments and the total length, the
+ * second copies the fragments into a single exact-size buffer.
+ */
+static xmlChar *
+xmlNodeConcatContent(const xmlNode *node, int list) {
+    xmlContentFrags frags;
+    xmlChar *ret = NULL;
+    xmlChar *cur;
+    int res, i;
+
+    frags.tab = frags.inl;
+    frags.nr = 0;
+    frags.max = XML_CONTENT_FRAGS_INLINE;
+    frags.size = 0;
+
+    if (list)
+        res = xmlNodeListWalkContent(node, xmlContentCollect, &frags);
+    else
+        res = xmlNodeWalkContent(node, xmlContentCollect, &frags);
+    if (res != 0)
+        goto done;
+
+    ret = xmlMalloc(frags.size + 1);
+    if (ret == NULL)
+        goto done;
+
+    cur = ret;
+    for (i = 0; i < frags.nr; i++) {
+        memcpy(cur, frags.tab[i].str, frags.tab[i].len);
+        cur += frags.tab[i].len;
+    }
+    *cur = 0;
+
+done:
+    if (frags.tab != frags.inl)
+        xmlFree(frags.tab);
+    return(ret);
+}
+
+static int
+xmlBufAddContent(void *ctxt, const xmlChar *content, int len) {
+    return(xmlBufAdd(ctxt, content, len) < 0 ? -1 : 0);
 }
 
 /**
- * Declares a new namespace on `elem`. It tries to use the
- * given `prefix`. If a ns-decl with the given prefix is already existent
- * on `elem`, it will generate an other prefix.
+ * Append the string value of a node to `buf`. For text nodes,
+ * the string value is the text content. Otherwise, the string value
+ * is the concatenation of the string values of the node's
+ * descendants.
  *
- * @param doc  the doc
- * @param elem  the element-node to declare on
- * @param nsName  the namespace-name of the ns-decl
- * @param prefix  the preferred prefix of the ns-decl
- * @param checkShadow  ensure that the new ns-decl doesn't shadow
- *                     ancestor ns-decls
- * @returns 1 if a ns-decl was found, 0 if not and -1 on API
- *          and internal errors.
+ * Entity references are substituted.
+ *
+ * @param buf  a buffer xmlBuf
+ * @param cur  the node being read
+ * @returns 0 in case of success and -1 in case of error.
  */
-static xmlNsPtr
-xmlDOMWrapNSNormDeclareNsForced(xmlDocPtr doc,
-				xmlNodePtr elem,
-				const xmlChar *nsName,
-				const xmlChar *prefix,
-				int checkShadow)
+int
+xmlBufGetNodeContent(xmlBuf *buf, const xmlNode *cur)
 {
+    if ((cur == NULL) || (buf == NULL))
+        return(-1);
 
-    xmlNsPtr ret;
-    char buf[50];
-    const xmlChar *pref;
-    int counter = 0;
+    xmlNodeWalkContent(cur, xmlBufAddContent, buf);
 
-    if ((doc == NULL) || (elem == NULL) || (elem->type != XML_ELEMENT_NODE))
-        return(NULL);
-    /*
-    * Create a ns-decl on @anchor.
-    */
-    pref = prefix;
-    while (1) {
-	/*
-	* Lookup whether the prefix is unused in elem's ns-decls.
-	*/
-	if ((elem->nsDef != NULL) &&
-	    (xmlTreeNSListLookupByPrefix(elem->nsDef, pref) != NULL))
-	    goto ns_next_prefix;
-	if (checkShadow && elem->parent &&
-	    ((xmlNodePtr) elem->parent->doc != elem->parent)) {
-	    /*
-	    * Does it shadow ancestor ns-decls?
-	    */
-	    if (xmlSearchNsByPrefixStrict(doc, elem->parent, pref, NULL) == 1)
-		goto ns_next_prefix;
-	}
-	ret = xmlNewNs(NULL, nsName, pref);
-	if (ret == NULL)
-	    return (NULL);
-	if (elem->nsDef == NULL)
-	    elem->nsDef = ret;
-	else {
-	    xmlNsPtr ns2 = elem->nsDef;
-	    while (ns2->next != NULL)
-		ns2 = ns2->next;
-	    ns2->next = ret;
-	}
-	return (ret);
-ns_next_prefix:
-	counter++;
-	if (counter > 1000)
-	    return (NULL);
-	if (prefix == NULL) {
-	    snprintf((char *) buf, sizeof(buf),
-		"ns_%d", counter);
-	} else
-	    snprintf((char *) buf, sizeof(buf),
-	    "%.30s_%d", (char *)prefix, counter);
-	pref = BAD_CAST buf;
-    }
+    return(0);
 }
 
 /**
- * Searches for a matching ns-name in the ns-decls of `nsMap`, if not
- * found it will either declare it on `elem`, or store it in `doc->oldNs`.
- * If a new ns-decl needs to be declared on `elem`, it tries to use the
- * `ns->prefix` for it, if this prefix is already in use on `elem`, it will
- * change the prefix or the new ns-decl.
+ * Returns the string value of a node. For text nodes, the string
+ * value is the text content. Otherwise, the string value is the
+ * concatenation of the string values of the node's descendants.
  *
- * @param doc  the doc
- * @param elem  the element-node to declare namespaces on
- * @param ns  the ns-struct to use for the search
- * @param retNs  the found/created ns-struct
- * @param nsMap  the ns-map
- * @param depth  the current tree depth
- * @param ancestorsOnly  search in ancestor ns-decls only
- * @param prefixed  if the searched ns-decl must have a prefix
- *                  (for attributes)
- * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ * Entity references are substituted.
+ *
+ * It's up to the caller to free the result with #xmlFree.
+ *
+ * @param cur  the node being read
+ * @returns a new string or NULL if arguments are invalid or a
+ * memory allocation failed.
  */
-static int
-xmlDOMWrapNSNormAcquireNormalizedNs(xmlDocPtr doc,
-				   xmlNodePtr elem,
-				   xmlNsPtr ns,
-				   xmlNsPtr *retNs,
-				   xmlNsMapPtr *nsMap,
-
-				   int depth,
-				   int ancestorsOnly,
-				   int prefixed)
+xmlChar *
+xmlNodeGetContent(const xmlNode *cur)
 {
-    xmlNsMapItemPtr mi;
+    if (cur == NULL)
+        return (NULL);
 
-    if ((doc == NULL) || (ns == NULL) || (retNs == NULL) ||
-	(nsMap == NULL))
-	return (-1);
+    switch (cur->type) {
+        case XML_DOCUMENT_NODE:
+        case XML_HTML_DOCUMENT_NODE:
+        case XML_ENTITY_REF_NODE:
+            break;
 
-    *retNs = NULL;
-    /*
-    * Handle XML namespace.
-    */
-    if (IS_STR_XML(ns->prefix)) {
-	/*
-	* Insert XML namespace mapping.
-	*/
-	*retNs = xmlTreeEnsureXMLDecl(doc);
-	if (*retNs == NULL)
-	    return (-1);
-	return (0);
-    }
-    /*
-    * If the search should be done in ancestors only and no
-    * @elem (the first ancestor) was specified, then skip the search.
-    */
-    if ((XML_NSMAP_NOTEMPTY(*nsMap)) &&
-	(! (ancestorsOnly && (elem == NULL))))
-    {
-	/*
-	* Try to find an equal ns-name in in-scope ns-decls.
-	*/
-	XML_NSMAP_FOREACH(*nsMap, mi) {
-	    if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
-		/*
-		* ancestorsOnly: This should be turned on to gain speed,
-		* if one knows that the branch itself was already
-		* ns-wellformed and no stale references existed.
-		* I.e. it searches in the ancestor axis only.
-		*/
-		((! ancestorsOnly) || (mi->depth == XML_TREE_NSMAP_PARENT)) &&
-		/* Skip shadowed prefixes. */
-		(mi->shadowDepth == -1) &&
-		/* Skip xmlns="" or xmlns:foo="". */
-		((mi->newNs->href != NULL) &&
-		(mi->newNs->href[0] != 0)) &&
-		/* Ensure a prefix if wanted. */
-		((! prefixed) || (mi->newNs->prefix != NULL)) &&
-		/* Equal ns name */
-		((mi->newNs->href == ns->href) ||
-		xmlStrEqual(mi->newNs->href, ns->href))) {
-		/* Set the mapping. */
-		mi->oldNs = ns;
-		*retNs = mi->newNs;
-		return (0);
-	    }
-	}
-    }
-    /*
-    * No luck, the namespace is out of scope or shadowed.
-    */
-    if (elem == NULL) {
-	xmlNsPtr tmpns;
+        case XML_DOCUMENT_FRAG_NODE:
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+        case XML_ENTITY_DECL: {
+            xmlNodePtr children = cur->children;
 
-	/*
-	* Store ns-decls in "oldNs" of the document-node.
-	*/
-	tmpns = xmlDOMWrapStoreNs(doc, ns->href, ns->prefix);
-	if (tmpns == NULL)
-	    return (-1);
-	/*
-	* Insert mapping.
-	*/
-	if (xmlDOMWrapNsMapAddItem(nsMap, -1, ns,
-		tmpns, XML_TREE_NSMAP_DOC) == NULL) {
-	    return (-1);
-	}
-	*retNs = tmpns;
-    } else {
-	xmlNsPtr tmpns;
+            if (children == NULL)
+                return(xmlStrdup(BAD_CAST ""));
 
-	tmpns = xmlDOMWrapNSNormDeclareNsForced(doc, elem, ns->href,
-	    ns->prefix, 0);
-	if (tmpns == NULL)
-	    return (-1);
+            /* Optimization for single text children */
+            if (((children->type == XML_TEXT_NODE) ||
+                 (children->type == XML_CDATA_SECTION_NODE)) &&
+                (children->next == NULL)) {
+                if (children->content == NULL)
+                    return(xmlStrdup(BAD_CAST ""));
+                return(xmlStrdup(children->content));
+            }
 
-	if (*nsMap != NULL) {
-	    /*
-	    * Does it shadow ancestor ns-decls?
-	    */
-	    XML_NSMAP_FOREACH(*nsMap, mi) {
-		if ((mi->depth < depth) &&
-		    (mi->shadowDepth == -1) &&
-		    ((ns->prefix == mi->newNs->prefix) ||
-		    xmlStrEqual(ns->prefix, mi->newNs->prefix))) {
-		    /*
-		    * Shadows.
-		    */
-		    mi->shadowDepth = depth;
-		    break;
-		}
-	    }
-	}
-	if (xmlDOMWrapNsMapAddItem(nsMap, -1, ns, tmpns, depth) == NULL) {
-	    return (-1);
-	}
-	*retNs = tmpns;
+            break;
+        }
+
+        case XML_CDATA_SECTION_NODE:
+        case XML_TEXT_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+            if (cur->content != NULL)
+                return(xmlStrdup(cur->content));
+            else
+                return(xmlStrdup(BAD_CAST ""));
+
+        case XML_NAMESPACE_DECL:
+	    return(xmlStrdup(((xmlNsPtr) cur)->href));
+
+        default:
+            return(NULL);
     }
-    return (0);
-}
 
-typedef enum {
-    XML_DOM_RECONNS_REMOVEREDUND = 1<<0
-} xmlDOMReconcileNSOptions;
+    return(xmlNodeConcatContent(cur, 0));
+}
 
 /**
- * Fix up namespaces.
+ * Like #xmlNodeGetContent but avoids copying if possible. If the
+ * string value is stored in the tree as a single string, for example
+ * if `cur` is a text node or an element with a single text child,
+ * a borrowed pointer is returned and `*mem` is set to NULL. The
+ * pointer is valid until the tree is modified.
  *
- * Ensures that ns-references point to ns-decls hold on element-nodes.
- * Ensures that the tree is namespace wellformed by creating additional
- * ns-decls where needed. Note that, since prefixes of already existent
- * ns-decls can be shadowed by this process, it could break QNames in
- * attribute values or element content.
+ * Otherwise, the string value is concatenated into a newly allocated
+ * buffer which is returned and also stored in `*mem`. The caller must
+ * free it with #xmlFree. If `mem` is NULL, no buffer is allocated and
+ * NULL is returned in this case.
  *
- * NOTE: This function was not intensively tested.
+ * @since 2.16.0
  *
- * @param ctxt  DOM wrapper context, unused at the moment
- * @param elem  the element-node
- * @param options  option flags
- * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ * @param cur  the node being read
+ * @param mem  pointer to the allocated string (optional)
+ * @returns the string value or NULL if arguments are invalid, a
+ * memory allocation failed or `mem` is NULL and the content can't
+ * be borrowed.
  */
-int
-xmlDOMWrapReconcileNamespaces(xmlDOMWrapCtxt *ctxt ATTRIBUTE_UNUSED,
-			      xmlNode *elem,
-			      int options)
+const xmlChar *
+xmlNodeBorrowContent(const xmlNode *cur, xmlChar **mem)
 {
-    int depth = -1, adoptns = 0, parnsdone = 0;
-    xmlNsPtr ns, prevns;
-    xmlDocPtr doc;
-    xmlNodePtr cur, curElem = NULL;
-    xmlNsMapPtr nsMap = NULL;
-    xmlNsMapItemPtr /* topmi = NULL, */ mi;
-    /* @ancestorsOnly should be set by an option flag. */
-    int ancestorsOnly = 0;
-    int optRemoveRedundantNS =
-	((xmlDOMReconcileNSOptions) options & XML_DOM_RECONNS_REMOVEREDUND) ? 1 : 0;
-    xmlNsPtr *listRedund = NULL;
-    int sizeRedund = 0, nbRedund = 0, ret = 0, i, j;
+    const xmlChar *content;
 
-    if ((elem == NULL) || (elem->doc == NULL) ||
-	(elem->type != XML_ELEMENT_NODE))
-	return (-1);
+    if (mem != NULL)
+        *mem = NULL;
+    if (cur == NULL)
+        return(NULL);
 
-    doc = elem->doc;
-    cur = elem;
-    do {
-	switch (cur->type) {
-	    case XML_ELEMENT_NODE:
-		adoptns = 1;
-		curElem = cur;
-		depth++;
-		/*
-		* Namespace declarations.
-		*/
-		if (cur->nsDef != NULL) {
-		    prevns = NULL;
-		    ns = cur->nsDef;
-		    while (ns != NULL) {
-			if (! parnsdone) {
-			    if ((elem->parent) &&
-				((xmlNodePtr) elem->parent->doc != elem->parent)) {
-				/*
-				* Gather ancestor in-scope ns-decls.
-				*/
-				if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
-				    elem->parent) == -1)
-				    ret = -1;
-			    }
-			    parnsdone = 1;
-			}
+    switch (cur->type) {
+        case XML_DOCUMENT_FRAG_NODE:
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE:
+        case XML_ENTITY_DECL: {
+            xmlNodePtr children = cur->children;
 
-			/*
-			* Lookup the ns ancestor-axis for equal ns-decls in scope.
-			*/
-			if (optRemoveRedundantNS && XML_NSMAP_NOTEMPTY(nsMap)) {
-			    XML_NSMAP_FOREACH(nsMap, mi) {
-				if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
-				    (mi->shadowDepth == -1) &&
-				    ((ns->prefix == mi->newNs->prefix) ||
-				      xmlStrEqual(ns->prefix, mi->newNs->prefix)) &&
-				    ((ns->href == mi->newNs->href) ||
-				      xmlStrEqual(ns->href, mi->newNs->href)))
-				{
-				    /*
-				    * A redundant ns-decl was found.
-				    * Add it to the list of redundant ns-decls.
-				    */
-				    if (xmlDOMWrapNSNormAddNsMapItem2(&listRedund,
-					&sizeRedund, &nbRedund, ns, mi->newNs) == -1) {
-					ret = -1;
-                                    } else {
-                                        /*
-                                        * Remove the ns-decl from the element-node.
-                                        */
-                                        if (prevns)
-                                            prevns->next = ns->next;
-                                        else
-                                            cur->nsDef = ns->next;
-                                        goto next_ns_decl;
-                                    }
-				}
-			    }
-			}
+            if (children == NULL)
+                return(BAD_CAST "");
+            if (((children->type != XML_TEXT_NODE) &&
+                 (children->type != XML_CDATA_SECTION_NODE)) ||
+                (children->next != NULL))
+                goto concat;
+            content = children->content;
+            break;
+        }
 
-			/*
-			* Skip ns-references handling if the referenced
-			* ns-decl is declared on the same element.
-			*/
-			if ((cur->ns != NULL) && adoptns && (cur->ns == ns))
-			    adoptns = 0;
-			/*
-			* Does it shadow any ns-decl?
-			*/
-			if (XML_NSMAP_NOTEMPTY(nsMap)) {
-			    XML_NSMAP_FOREACH(nsMap, mi) {
-				if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
-				    (mi->shadowDepth == -1) &&
-				    ((ns->prefix == mi->newNs->prefix) ||
-				    xmlStrEqual(ns->prefix, mi->newNs->prefix))) {
+        case XML_CDATA_SECTION_NODE:
+        case XML_TEXT_NODE:
+        case XML_COMMENT_NODE:
+        case XML_PI_NODE:
+            content = cur->content;
+            break;
 
-				    mi->shadowDepth = depth;
-				}
-			    }
-			}
-			/*
-			* Push mapping.
-			*/
-			if (xmlDOMWrapNsMapAddItem(&nsMap, -1, ns, ns,
-			    depth) == NULL)
-			    ret = -1;
+        case XML_NAMESPACE_DECL:
+            content = ((xmlNsPtr) cur)->href;
+            break;
 
-			prevns = ns;
-next_ns_decl:
-			ns = ns->next;
-		    }
-		}
-		if (! adoptns)
-		    goto ns_end;
-                /* Falls through. */
-	    case XML_ATTRIBUTE_NODE:
-		/* No ns, no fun. */
-		if (cur->ns == NULL)
-		    goto ns_end;
+        case XML_DOCUMENT_NODE:
+        case XML_HTML_DOCUMENT_NODE:
+        case XML_ENTITY_REF_NODE:
+            goto concat;
 
-		if (! parnsdone) {
-		    if ((elem->parent) &&
-			((xmlNodePtr) elem->parent->doc != elem->parent)) {
-			if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
-				elem->parent) == -1)
-			    ret = -1;
-		    }
-		    parnsdone = 1;
-		}
-		/*
-		* Adjust the reference if this was a redundant ns-decl.
-		*/
-		if (listRedund) {
-		   for (i = 0, j = 0; i < nbRedund; i++, j += 2) {
-		       if (cur->ns == listRedund[j]) {
-			   cur->ns = listRedund[++j];
-			   break;
-		       }
-		   }
-		}
-		/*
-		* Adopt ns-references.
-		*/
-		if (XML_NSMAP_NOTEMPTY(nsMap)) {
-		    /*
-		    * Search for a mapping.
-		    */
-		    XML_NSMAP_FOREACH(nsMap, mi) {
-			if ((mi->shadowDepth == -1) &&
-			    (cur->ns == mi->oldNs)) {
+        default:
+            return(NULL);
+    }
 
-			    cur->ns = mi->newNs;
-			    goto ns_end;
-			}
-		    }
-		}
-		/*
-		* Acquire a normalized ns-decl and add it to the map.
-		*/
-		if (xmlDOMWrapNSNormAcquireNormalizedNs(doc, curElem,
-			cur->ns, &ns,
-			&nsMap, depth,
-			ancestorsOnly,
-			(cur->type == XML_ATTRIBUTE_NODE) ? 1 : 0) == -1)
-		    ret = -1;
-		cur->ns = ns;
+    return((content != NULL) ? content : BAD_CAST "");
 
-ns_end:
-		if ((cur->type == XML_ELEMENT_NODE) &&
-		    (cur->properties != NULL)) {
-		    /*
-		    * Process attributes.
-		    */
-		    cur = (xmlNodePtr) cur->properties;
-		    continue;
-		}
-		break;
-	    default:
-		goto next_sibling;
-	}
-into_content:
-	if ((cur->type == XML_ELEMENT_NODE) &&
-	    (cur->children != NULL)) {
-	    /*
-	    * Process content of element-nodes only.
-	    */
-	    cur = cur->children;
-	    continue;
-	}
-next_sibling:
-	if (cur == elem)
+concat:
+    if (mem == NULL)
+        return(NULL);
+    *mem = xmlNodeConcatContent(cur, 0);
+    return(*mem);
+}
+
+static int
+xmlNodeSetContentInternal(xmlNodePtr cur, const xmlChar *content, int len) {
+    if (cur == NULL) {
+	return(1);
+    }
+    switch (cur->type) {
+        case XML_DOCUMENT_FRAG_NODE:
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE: {
+            size_t maxSize = len < 0 ? SIZE_MAX : (size_t) len;
+
+            xmlDocIndexAttrChanged(cur);
+            xmlNodeSourceChanged(cur);
+
+            /*
+             * We shouldn't parse the content as attribute value here,
+             * but the API can't be changed.
+             */
+            if (xmlNodeParseAttValue(cur->doc, (xmlAttr *) cur,
+                                     content, maxSize, NULL) < 0)
+                return(-1);
 	    break;
-	if (cur->type == XML_ELEMENT_NODE) {
-	    if (XML_NSMAP_NOTEMPTY(nsMap)) {
-		/*
-		* Pop mappings.
-		*/
-		while ((nsMap->last != NULL) &&
-		    (nsMap->last->depth >= depth))
-		{
-		    XML_NSMAP_POP(nsMap, mi)
-		}
-		/*
-		* Unshadow.
-		*/
-		XML_NSMAP_FOREACH(nsMap, mi) {
-		    if (mi->shadowDepth >= depth)
-			mi->shadowDepth = -1;
-		}
-	    }
-	    depth--;
-	}
-	if (cur->next != NULL)
-	    cur = cur->next;
-	else {
-	    if (cur->type == XML_ATTRIBUTE_NODE) {
-		cur = cur->parent;
-		goto into_content;
+        }
+
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_PI_NODE:
+        case XML_COMMENT_NODE: {
+            xmlChar *copy = NULL;
+
+	    if (content != NULL) {
+                if (len < 0)
+                    copy = xmlStrdup(content);
+                else
+		    copy = xmlStrndup(content, len);
+                if (copy == NULL)
+                    return(-1);
 	    }
-	    cur = cur->parent;
-	    goto next_sibling;
-	}
-    } while (cur != NULL);
 
-    if (listRedund) {
-	for (i = 0, j = 0; i < nbRedund; i++, j += 2) {
-	    xmlFreeNs(listRedund[j]);
-	}
-	xmlFree(listRedund);
+            xmlTextSetContent(cur, copy);
+	    break;
+        }
+
+        default:
+            break;
     }
-    if (nsMap != NULL)
-	xmlDOMWrapNsMapFree(nsMap);
-    return (ret);
+
+    return(0);
 }
 
 /**
- * Ensures that ns-references point to `destDoc`: either to
- * `elements->nsDef` entries if `destParent` is given, or to
- * `destDoc->oldNs` otherwise.
+ * Replace the text content of a node.
  *
- * If `destParent` is given, it ensures that the tree is namespace
- * wellformed by creating additional ns-decls where needed.
- * Note that, since prefixes of already existent ns-decls can be
- * shadowed by this process, it could break QNames in attribute
- * values or element content.
+ * Sets the raw text content of text, CDATA, comment or PI nodes.
  *
- * NOTE: This function was not intensively tested.
+ * For element and attribute nodes, removes all children and
+ * replaces them by parsing `content` which is expected to be a
+ * valid XML attribute value possibly containing character and
+ * entity references. Syntax errors and references to undeclared
+ * entities are ignored silently. Unfortunately, there isn't an
+ * API to pass raw content directly. An inefficient work-around
+ * is to escape the content with #xmlEncodeSpecialChars before
+ * passing it. A better trick is clearing the old content
+ * with `xmlNodeSetContent(node, NULL)` first and then calling
+ * `xmlNodeAddContent(node, content)`. Unlike this function,
+ * #xmlNodeAddContent accepts raw text.
  *
- * @param ctxt  the optional context for custom processing
- * @param sourceDoc  the optional sourceDoc
- * @param node  the element-node to start with
- * @param destDoc  the destination doc for adoption
- * @param destParent  the optional new parent of `node` in `destDoc`
- * @param options  option flags
- * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ * @param cur  the node being modified
+ * @param content  the new value of the content
+ * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
  */
-static int
-xmlDOMWrapAdoptBranch(xmlDOMWrapCtxtPtr ctxt,
-		      xmlDocPtr sourceDoc ATTRIBUTE_UNUSED,
-		      xmlNodePtr node,
-		      xmlDocPtr destDoc,
-		      xmlNodePtr destParent,
-		      int options ATTRIBUTE_UNUSED)
-{
-    int ret = 0;
-    xmlNodePtr cur, curElem = NULL;
-    xmlNsMapPtr nsMap = NULL;
-    xmlNsMapItemPtr mi;
-    xmlNsPtr ns = NULL;
-    int depth = -1;
-    /* gather @parent's ns-decls. */
-    int parnsdone;
-    /* @ancestorsOnly should be set per option. */
-    int ancestorsOnly = 0;
-
-    /*
-    * Get the ns-map from the context if available.
-    */
-    if (ctxt)
-	nsMap = (xmlNsMapPtr) ctxt->namespaceMap;
-    /*
-    * Disable search for ns-decls in the parent-axis of the
-    * destination element, if:
-    * 1) there's no destination parent
-    * 2) custom ns-reference handling is used
-    */
-    if ((destParent == NULL) ||
-	(ctxt && ctxt->getNsForNodeFunc))
-    {
-	parnsdone = 1;
-    } else
-	parnsdone = 0;
-
-    cur = node;
+int
+xmlNodeSetContent(xmlNode *cur, const xmlChar *content) {
+    return(xmlNodeSetContentInternal(cur, content, -1));
+}
 
-    while (cur != NULL) {
-        if (cur->doc != destDoc) {
-            if (xmlNodeSetDoc(cur, destDoc) < 0)
-                ret = -1;
-        }
+/**
+ * See #xmlNodeSetContent.
+ *
+ * @param cur  the node being modified
+ * @param content  the new value of the content
+ * @param len  the size of `content`
+ * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
+ */
+int
+xmlNodeSetContentLen(xmlNode *cur, const xmlChar *content, int len) {
+    return(xmlNodeSetContentInternal(cur, content, len));
+}
 
-	switch (cur->type) {
-	    case XML_XINCLUDE_START:
-	    case XML_XINCLUDE_END:
-		/*
-		* TODO
-		*/
-		ret = -1;
-                goto leave_node;
-	    case XML_ELEMENT_NODE:
-		curElem = cur;
-		depth++;
-		/*
-		* Namespace declarations.
-		* - ns->href and ns->prefix are never in the dict, so
-		*   we need not move the values over to the destination dict.
-		* - Note that for custom handling of ns-references,
-		*   the ns-decls need not be stored in the ns-map,
-		*   since they won't be referenced by node->ns.
-		*/
-		if ((cur->nsDef) &&
-		    ((ctxt == NULL) || (ctxt->getNsForNodeFunc == NULL)))
-		{
-		    if (! parnsdone) {
-			/*
-			* Gather @parent's in-scope ns-decls.
-			*/
-			if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
-			    destParent) == -1)
-			    ret = -1;
-			parnsdone = 1;
-		    }
-		    for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
-			/*
-			* NOTE: ns->prefix and ns->href are never in the dict.
-			*/
-			/*
-			* Does it shadow any ns-decl?
-			*/
-			if (XML_NSMAP_NOTEMPTY(nsMap)) {
-			    XML_NSMAP_FOREACH(nsMap, mi) {
-				if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
-				    (mi->shadowDepth == -1) &&
-				    ((ns->prefix == mi->newNs->prefix) ||
-				    xmlStrEqual(ns->prefix,
-				    mi->newNs->prefix))) {
-
-				    mi->shadowDepth = depth;
-				}
-			    }
-			}
-			/*
-			* Push mapping.
-			*/
-			if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
-			    ns, ns, depth) == NULL)
-			    ret = -1;
-		    }
-		}
-                /* Falls through. */
-	    case XML_ATTRIBUTE_NODE:
-		/* No namespace, no fun. */
-		if (cur->ns == NULL)
-		    goto ns_end;
-
-		if (! parnsdone) {
-		    if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
-			destParent) == -1)
-			ret = -1;
-		    parnsdone = 1;
-		}
-		/*
-		* Adopt ns-references.
-		*/
-		if (XML_NSMAP_NOTEMPTY(nsMap)) {
-		    /*
-		    * Search for a mapping.
-		    */
-		    XML_NSMAP_FOREACH(nsMap, mi) {
-			if ((mi->shadowDepth == -1) &&
-			    (cur->ns == mi->oldNs)) {
-
-			    cur->ns = mi->newNs;
-			    goto ns_end;
-			}
-		    }
-		}
-		/*
-		* No matching namespace in scope. We need a new one.
-		*/
-		if ((ctxt) && (ctxt->getNsForNodeFunc)) {
-		    /*
-		    * User-defined behaviour.
-		    */
-		    ns = ctxt->getNsForNodeFunc(ctxt, cur,
-			cur->ns->href, cur->ns->prefix);
-		    /*
-		    * Insert mapping if ns is available; it's the users fault
-		    * if not.
-		    */
-		    if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
-			    cur->ns, ns, XML_TREE_NSMAP_CUSTOM) == NULL)
-			ret = -1;
-		    cur->ns = ns;
-		} else {
-		    /*
-		    * Acquire a normalized ns-decl and add it to the map.
-		    */
-		    if (xmlDOMWrapNSNormAcquireNormalizedNs(destDoc,
-			/* ns-decls on curElem or on destDoc->oldNs */
-			destParent ? curElem : NULL,
-			cur->ns, &ns,
-			&nsMap, depth,
-			ancestorsOnly,
-			/* ns-decls must be prefixed for attributes. */
-			(cur->type == XML_ATTRIBUTE_NODE) ? 1 : 0) == -1)
-			ret = -1;
-		    cur->ns = ns;
-		}
+/**
+ * Append the extra substring to the node content.
+ *
+ * NOTE: In contrast to #xmlNodeSetContentLen, `content` is supposed
+ * to be raw text, so unescaped XML special chars are allowed, entity
+ * references are not supported.
+ *
+ * This doesn't work on attributes before version 2.15.
+ *
+ * @param cur  the node being modified
+ * @param content  extra content
+ * @param len  the size of `content`
+ * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
+ */
+int
+xmlNodeAddContentLen(xmlNode *cur, const xmlChar *content, int len) {
+    if (cur == NULL)
+	return(1);
+    if ((content == NULL) || (len <= 0))
+        return(0);
 
-ns_end:
-		if (cur->type == XML_ELEMENT_NODE) {
-		    cur->psvi = NULL;
-		    cur->line = 0;
-		    cur->extra = 0;
-		    /*
-		    * Walk attributes.
-		    */
-		    if (cur->properties != NULL) {
-			/*
-			* Process first attribute node.
-			*/
-			cur = (xmlNodePtr) cur->properties;
-			continue;
-		    }
-		}
-		break;
-	    case XML_TEXT_NODE:
-	    case XML_CDATA_SECTION_NODE:
-	    case XML_PI_NODE:
-	    case XML_COMMENT_NODE:
-	    case XML_ENTITY_REF_NODE:
-		goto leave_node;
-	    default:
-		ret = -1;
-	}
-	/*
-	* Walk the tree.
-	*/
-	if (cur->children != NULL) {
-	    cur = cur->children;
-	    continue;
-	}
+    switch (cur->type) {
+        case XML_DOCUMENT_FRAG_NODE:
+        case XML_ELEMENT_NODE:
+        case XML_ATTRIBUTE_NODE: {
+	    xmlNodePtr newNode, tmp;
 
-leave_node:
-	if (cur == node)
+	    newNode = xmlNewDocTextLen(cur->doc, content, len);
+	    if (newNode == NULL)
+                return(-1);
+            tmp = xmlAddChild(cur, newNode);
+            if (tmp == NULL) {
+                xmlFreeNode(newNode);
+                return(-1);
+            }
 	    break;
-	if ((cur->type == XML_ELEMENT_NODE) ||
-	    (cur->type == XML_XINCLUDE_START) ||
-	    (cur->type == XML_XINCLUDE_END))
-	{
-	    /*
-	    * TODO: Do we expect nsDefs on XML_XINCLUDE_START?
-	    */
-	    if (XML_NSMAP_NOTEMPTY(nsMap)) {
-		/*
-		* Pop mappings.
-		*/
-		while ((nsMap->last != NULL) &&
-		    (nsMap->last->depth >= depth))
-		{
-		    XML_NSMAP_POP(nsMap, mi)
-		}
-		/*
-		* Unshadow.
-		*/
-		XML_NSMAP_FOREACH(nsMap, mi) {
-		    if (mi->shadowDepth >= depth)
-			mi->shadowDepth = -1;
-		}
-	    }
-	    depth--;
-	}
-	if (cur->next != NULL)
-	    cur = cur->next;
-	else if ((cur->type == XML_ATTRIBUTE_NODE) &&
-	    (cur->parent->children != NULL))
-	{
-	    cur = cur->parent->children;
-	} else {
-	    cur = cur->parent;
-	    goto leave_node;
 	}
+	    break;
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_PI_NODE:
+        case XML_COMMENT_NODE:
+            return(xmlTextAddContent(cur, content, len));
+        default:
+            break;
     }
 
-    /*
-    * Cleanup.
-    */
-    if (nsMap != NULL) {
-	if ((ctxt) && (ctxt->namespaceMap == nsMap)) {
-	    /*
-	    * Just cleanup the map but don't free.
-	    */
-	    if (nsMap->first) {
-		if (nsMap->pool)
-		    nsMap->last->next = nsMap->pool;
-		nsMap->pool = nsMap->first;
-		nsMap->first = NULL;
-	    }
-	} else
-	    xmlDOMWrapNsMapFree(nsMap);
-    }
-    return(ret);
+    return(0);
 }
 
 /**
- * Clone a node and fix namespaces.
+ * Append the extra substring to the node content.
  *
- * References of out-of scope ns-decls are remapped to point to `destDoc`.
- * If `destParent` is given, then nsDef entries on element-nodes are used.
- * If *no* `destParent` is given, then `destDoc->oldNs` entries are used.
- * This is the case when you don't know already where the cloned branch
- * will be added to.
+ * NOTE: In contrast to #xmlNodeSetContent, `content` is supposed
+ * to be raw text, so unescaped XML special chars are allowed, entity
+ * references are not supported.
  *
- * If `destParent` is given, it ensures that the tree is namespace
- * wellformed by creating additional ns-decls where needed.
- * Note that, since prefixes of already existent ns-decls can be
- * shadowed by this process, it could break QNames in attribute
- * values or element content.
+ * This doesn't work on attributes before version 2.15.
  *
- * @param ctxt  the optional context for custom processing
- * @param sourceDoc  the optional sourceDoc
- * @param node  the node to start with
- * @param resNode  the clone of the given `node`
- * @param destDoc  the destination doc
- * @param destParent  the optional new parent of `node` in `destDoc`
- * @param deep  descend into child if set
- * @param options  option flags
- * @returns 0 if the operation succeeded,
- *          1 if a node of unsupported (or not yet supported) type was given,
- *          -1 on API/internal errors.
+ * @param cur  the node being modified
+ * @param content  extra content
+ * @returns 0 on success, 1 on error, -1 if a memory allocation failed.
  */
 int
-xmlDOMWrapCloneNode(xmlDOMWrapCtxt *ctxt,
-		      xmlDoc *sourceDoc,
-		      xmlNode *node,
-		      xmlNode **resNode,
-		      xmlDoc *destDoc,
-		      xmlNode *destParent,
-		      int deep,
-		      int options ATTRIBUTE_UNUSED)
-{
-    int ret = 0;
-    xmlNodePtr cur, cloneElem = NULL;
-    xmlNsMapPtr nsMap = NULL;
-    xmlNsMapItemPtr mi;
-    xmlNsPtr ns;
-    int depth = -1;
-    /* int adoptStr = 1; */
-    /* gather @parent's ns-decls. */
-    int parnsdone = 0;
-    /*
-    * @ancestorsOnly:
-    * TODO: @ancestorsOnly should be set per option.
-    *
-    */
-    int ancestorsOnly = 0;
-    xmlNodePtr resultClone = NULL, clone = NULL, parentClone = NULL, prevClone = NULL;
-    xmlNsPtr cloneNs = NULL, *cloneNsDefSlot = NULL;
-    xmlDictPtr dict; /* The destination dict */
+xmlNodeAddContent(xmlNode *cur, const xmlChar *content) {
+    return(xmlNodeAddContentLen(cur, content, xmlStrlen(content)));
+}
 
-    if ((node == NULL) || (resNode == NULL) || (destDoc == NULL) ||
-	((destParent != NULL) && (destParent->doc != destDoc)))
-	return(-1);
-    /*
-    * TODO: Initially we support only element-nodes.
-    */
-    if (node->type != XML_ELEMENT_NODE)
-	return(1);
-    /*
-    * Check node->doc sanity.
-    */
-    if ((node->doc != NULL) && (sourceDoc != NULL) &&
-	(node->doc != sourceDoc)) {
-	/*
-	* Might be an XIncluded node.
-	*/
-	return (-1);
-    }
-    if (sourceDoc == NULL)
-	sourceDoc = node->doc;
-    if (sourceDoc == NULL)
-        return (-1);
+/**
+ * Merge the second text node into the first. If `first` is NULL,
+ * `second` is returned. Otherwise, the second node is unlinked and
+ * freed.
+ *
+ * @param first  the first text node
+ * @param second  the second text node being merged
+ * @returns the first text node augmented or NULL in case of error.
+ */
+xmlNode *
+xmlTextMerge(xmlNode *first, xmlNode *second) {
+    if (first == NULL)
+        return(second);
+    if (second == NULL)
+        return(first);
 
-    dict = destDoc->dict;
-    /*
-    * Reuse the namespace map of the context.
-    */
-    if (ctxt)
-	nsMap = (xmlNsMapPtr) ctxt->namespaceMap;
+    if ((first->type != XML_TEXT_NODE) ||
+        (second->type != XML_TEXT_NODE) ||
+        (first == second) ||
+        (first->name != second->name))
+	return(NULL);
 
-    *resNode = NULL;
+    if (xmlTextAddContent(first, second->content, -1) < 0)
+        return(NULL);
 
-    cur = node;
-    while (cur != NULL) {
-	if (cur->doc != sourceDoc) {
-	    /*
-	    * We'll assume XIncluded nodes if the doc differs.
-	    * TODO: Do we need to reconciliate XIncluded nodes?
-	    * TODO: This here returns -1 in this case.
-	    */
-	    goto internal_error;
-	}
-	/*
-	* Create a new node.
-	*/
-	switch (cur->type) {
-	    case XML_XINCLUDE_START:
-	    case XML_XINCLUDE_END:
-		/*
-		* TODO: What to do with XInclude?
-		*/
-		goto internal_error;
-		break;
-	    case XML_ELEMENT_NODE:
-	    case XML_TEXT_NODE:
-	    case XML_CDATA_SECTION_NODE:
-	    case XML_COMMENT_NODE:
-	    case XML_PI_NODE:
-	    case XML_DOCUMENT_FRAG_NODE:
-	    case XML_ENTITY_REF_NODE:
-		/*
-		* Nodes of xmlNode structure.
-		*/
-		clone = (xmlNodePtr) xmlMalloc(sizeof(xmlNode));
-		if (clone == NULL)
-		    goto internal_error;
-		memset(clone, 0, sizeof(xmlNode));
-		/*
-		* Set hierarchical links.
-		*/
-		if (resultClone != NULL) {
-		    clone->parent = parentClone;
-		    if (prevClone) {
-			prevClone->next = clone;
-			clone->prev = prevClone;
-		    } else
-			parentClone->children = clone;
-                    parentClone->last = clone;
-		} else
-		    resultClone = clone;
+    xmlUnlinkNodeInternal(second);
+    xmlFreeNode(second);
+    return(first);
+}
 
-		break;
-	    case XML_ATTRIBUTE_NODE:
-		/*
-		* Attributes (xmlAttr).
-		*/
-		clone = xmlMalloc(sizeof(xmlAttr));
-		if (clone == NULL)
-		    goto internal_error;
-		memset(clone, 0, sizeof(xmlAttr));
-		/*
-		* Set hierarchical links.
-		* TODO: Change this to add to the end of attributes.
-		*/
-		if (resultClone != NULL) {
-		    clone->parent = parentClone;
-		    if (prevClone) {
-			prevClone->next = clone;
-			clone->prev = prevClone;
-		    } else
-			parentClone->properties = (xmlAttrPtr) clone;
-		} else
-		    resultClone = clone;
-		break;
-	    default:
-		/*
-		* TODO QUESTION: Any other nodes expected?
-		*/
-		goto internal_error;
-	}
+/**
+ * Find all in-scope namespaces of a node. `out` returns a NULL
+ * terminated array of namespace pointers that must be freed by
+ * the caller.
+ *
+ * @since 2.13.0
+ *
+ * @param doc  the document
+ * @param node  the current node
+ * @param out  the returned namespace array
+ * @returns 0 on success, 1 if no namespaces were found, -1 if a
+ * memory allocation failed.
+ */
+int
+xmlGetNsListSafe(const xmlDoc *doc ATTRIBUTE_UNUSED, const xmlNode *node,
+                 xmlNs ***out)
+{
+    xmlNsPtr cur;
+    xmlNsPtr *namespaces = NULL;
+    int nbns = 0;
+    int maxns = 0;
+    int i;
 
-	clone->type = cur->type;
-	clone->doc = destDoc;
+    if (out == NULL)
+        return(1);
+    *out = NULL;
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
+        return(1);
 
-	/*
-	* Clone the name of the node if any.
-	*/
-	if (cur->name == xmlStringText)
-	    clone->name = xmlStringText;
-	else if (cur->name == xmlStringTextNoenc)
-	    /*
-	    * NOTE: Although xmlStringTextNoenc is never assigned to a node
-	    *   in tree.c, it might be set in Libxslt via
-	    *   "xsl:disable-output-escaping".
-	    */
-	    clone->name = xmlStringTextNoenc;
-	else if (cur->name == xmlStringComment)
-	    clone->name = xmlStringComment;
-	else if (cur->name != NULL) {
-            if (dict != NULL)
-                clone->name = xmlDictLookup(dict, cur->name, -1);
-            else
-                clone->name = xmlStrdup(cur->name);
-            if (clone->name == NULL)
-                goto internal_error;
-	}
+    while (node != NULL) {
+        if (node->type == XML_ELEMENT_NODE) {
+            cur = node->nsDef;
+            while (cur != NULL) {
+                for (i = 0; i < nbns; i++) {
+                    if ((cur->prefix == namespaces[i]->prefix) ||
+                        (xmlStrEqual(cur->prefix, namespaces[i]->prefix)))
+                        break;
+                }
+                if (i >= nbns) {
+                    if (nbns >= maxns) {
+                        xmlNsPtr *tmp;
+                        int newSize;
 
-	switch (cur->type) {
-	    case XML_XINCLUDE_START:
-	    case XML_XINCLUDE_END:
-		/*
-		* TODO
-		*/
-		return (-1);
-	    case XML_ELEMENT_NODE:
-		cloneElem = clone;
-		depth++;
-		/*
-		* Namespace declarations.
-		*/
-		if (cur->nsDef != NULL) {
-		    if (! parnsdone) {
-			if (destParent && (ctxt == NULL)) {
-			    /*
-			    * Gather @parent's in-scope ns-decls.
-			    */
-			    if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
-				destParent) == -1)
-				goto internal_error;
-			}
-			parnsdone = 1;
-		    }
-		    /*
-		    * Clone namespace declarations.
-		    */
-		    cloneNsDefSlot = &(clone->nsDef);
-		    for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
-			/*
-			* Create a new xmlNs.
-			*/
-			cloneNs = (xmlNsPtr) xmlMalloc(sizeof(xmlNs));
-			if (cloneNs == NULL)
-			    goto internal_error;
-			memset(cloneNs, 0, sizeof(xmlNs));
-			cloneNs->type = XML_LOCAL_NAMESPACE;
-
-			if (ns->href != NULL) {
-			    cloneNs->href = xmlStrdup(ns->href);
-                            if (cloneNs->href == NULL) {
-                                xmlFreeNs(cloneNs);
-                                goto internal_error;
-                            }
+                        newSize = xmlGrowCapacity(maxns, sizeof(tmp[0]),
+                                                  10, XML_MAX_ITEMS);
+                        if (newSize < 0) {
+                            xmlFree(namespaces);
+                            return(-1);
                         }
-			if (ns->prefix != NULL) {
-			    cloneNs->prefix = xmlStrdup(ns->prefix);
-                            if (cloneNs->prefix == NULL) {
-                                xmlFreeNs(cloneNs);
-                                goto internal_error;
-                            }
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+                        if (newSize < 2)
+                            newSize = 2;
+#endif
+                        tmp = xmlRealloc(namespaces,
+                                         (newSize + 1) * sizeof(tmp[0]));
+                        if (tmp == NULL) {
+                            xmlFree(namespaces);
+                            return(-1);
                         }
+                        namespaces = tmp;
+                        maxns = newSize;
+                    }
+                    namespaces[nbns++] = cur;
+                    namespaces[nbns] = NULL;
+                }
 
-			*cloneNsDefSlot = cloneNs;
-			cloneNsDefSlot = &(cloneNs->next);
+                cur = cur->next;
+            }
+        }
+        node = node->parent;
+    }
 
-			/*
-			* Note that for custom handling of ns-references,
-			* the ns-decls need not be stored in the ns-map,
-			* since they won't be referenced by node->ns.
-			*/
-			if ((ctxt == NULL) ||
-			    (ctxt->getNsForNodeFunc == NULL))
-			{
-			    /*
-			    * Does it shadow any ns-decl?
-			    */
-			    if (XML_NSMAP_NOTEMPTY(nsMap)) {
-				XML_NSMAP_FOREACH(nsMap, mi) {
-				    if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
-					(mi->shadowDepth == -1) &&
-					((ns->prefix == mi->newNs->prefix) ||
-					xmlStrEqual(ns->prefix,
-					mi->newNs->prefix))) {
-					/*
-					* Mark as shadowed at the current
-					* depth.
-					*/
-					mi->shadowDepth = depth;
-				    }
-				}
-			    }
-			    /*
-			    * Push mapping.
-			    */
-			    if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
-				ns, cloneNs, depth) == NULL)
-				goto internal_error;
-			}
-		    }
-		}
-		/* cur->ns will be processed further down. */
-		break;
-	    case XML_ATTRIBUTE_NODE:
-		/* IDs will be processed further down. */
-		/* cur->ns will be processed further down. */
-		break;
-	    case XML_PI_NODE:
-	    case XML_COMMENT_NODE:
-	    case XML_TEXT_NODE:
-	    case XML_CDATA_SECTION_NODE:
-		/*
-		* Note that this will also cover the values of attributes.
-		*/
-                if (cur->content != NULL) {
-                    clone->content = xmlStrdup(cur->content);
-                    if (clone->content == NULL)
-                        goto internal_error;
-                }
-		goto leave_node;
-	    case XML_ENTITY_REF_NODE:
-		if (sourceDoc != destDoc) {
-		    if ((destDoc->intSubset) || (destDoc->extSubset)) {
-			xmlEntityPtr ent;
-			/*
-			* Different doc: Assign new entity-node if available.
-			*/
-			ent = xmlGetDocEntity(destDoc, cur->name);
-			if (ent != NULL) {
-			    clone->content = ent->content;
-			    clone->children = (xmlNodePtr) ent;
-			    clone->last = (xmlNodePtr) ent;
-			}
-		    }
-		} else {
-		    /*
-		    * Same doc: Use the current node's entity declaration
-		    * and value.
-		    */
-		    clone->content = cur->content;
-		    clone->children = cur->children;
-		    clone->last = cur->last;
-		}
-		goto leave_node;
-	    default:
-		goto internal_error;
-	}
+    *out = namespaces;
+    return((namespaces == NULL) ? 1 : 0);
+}
 
-	if (cur->ns == NULL)
-	    goto end_ns_reference;
+/**
+ * Find all in-scope namespaces of a node.
+ *
+ * Use #xmlGetNsListSafe for better error reporting.
+ *
+ * @param doc  the document
+ * @param node  the current node
+ * @returns a NULL terminated array of namespace pointers that must
+ * be freed by the caller or NULL if no namespaces were found or
+ * a memory allocation failed.
+ */
+xmlNs **
+xmlGetNsList(const xmlDoc *doc, const xmlNode *node)
+{
+    xmlNsPtr *ret;
 
-/* handle_ns_reference: */
-	/*
-	** The following will take care of references to ns-decls ********
-	** and is intended only for element- and attribute-nodes.
-	**
-	*/
-	if (! parnsdone) {
-	    if (destParent && (ctxt == NULL)) {
-		if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap, destParent) == -1)
-		    goto internal_error;
-	    }
-	    parnsdone = 1;
-	}
-	/*
-	* Adopt ns-references.
-	*/
-	if (XML_NSMAP_NOTEMPTY(nsMap)) {
-	    /*
-	    * Search for a mapping.
-	    */
-	    XML_NSMAP_FOREACH(nsMap, mi) {
-		if ((mi->shadowDepth == -1) &&
-		    (cur->ns == mi->oldNs)) {
-		    /*
-		    * This is the nice case: a mapping was found.
-		    */
-		    clone->ns = mi->newNs;
-		    goto end_ns_reference;
-		}
-	    }
-	}
-	/*
-	* No matching namespace in scope. We need a new one.
-	*/
-	if ((ctxt != NULL) && (ctxt->getNsForNodeFunc != NULL)) {
-	    /*
-	    * User-defined behaviour.
-	    */
-	    ns = ctxt->getNsForNodeFunc(ctxt, cur,
-		cur->ns->href, cur->ns->prefix);
-	    /*
-	    * Add user's mapping.
-	    */
-	    if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
-		cur->ns, ns, XML_TREE_NSMAP_CUSTOM) == NULL)
-		goto internal_error;
-	    clone->ns = ns;
-	} else {
-	    /*
-	    * Acquire a normalized ns-decl and add it to the map.
-	    */
-	    if (xmlDOMWrapNSNormAcquireNormalizedNs(destDoc,
-		/* ns-decls on cloneElem or on destDoc->oldNs */
-		destParent ? cloneElem : NULL,
-		cur->ns, &ns,
-		&nsMap, depth,
-		/* if we need to search only in the ancestor-axis */
-		ancestorsOnly,
-		/* ns-decls must be prefixed for attributes. */
-		(cur->type == XML_ATTRIBUTE_NODE) ? 1 : 0) == -1)
-		goto internal_error;
-	    clone->ns = ns;
-	}
+    xmlGetNsListSafe(doc, node, &ret);
+    return(ret);
+}
 
-end_ns_reference:
+static xmlNsPtr
+xmlNewXmlNs(xmlDictPtr dict) {
+    xmlNsPtr ns;
 
-	/*
-	* Some post-processing.
-	*
-	* Handle ID attributes.
-	*/
-	if ((clone->type == XML_ATTRIBUTE_NODE) &&
-	    (clone->parent != NULL))
-	{
-            int res;
+    ns = (xmlNsPtr) xmlMalloc(sizeof(xmlNs));
+    if (ns == NULL)
+        return(NULL);
+    memset(ns, 0, sizeof(xmlNs));
+    ns->type = XML_LOCAL_NAMESPACE;
+    ns->href = xmlStrdup(XML_XML_NAMESPACE);
+    if (ns->href == NULL) {
+        xmlFreeNs(ns);
+        return(NULL);
+    }
+    xmlDictNsId(dict, ns->href, 1);
+    ns->prefix = xmlStrdup(BAD_CAST "xml");
+    if (ns->prefix == NULL) {
+        xmlFreeNs(ns);
+        return(NULL);
+    }
 
-	    res = xmlIsID(destDoc, clone->parent, (xmlAttrPtr) clone);
-            if (res < 0)
-                goto internal_error;
-            if (res == 1) {
-		xmlChar *idVal;
+    return(ns);
+}
 
-		idVal = xmlNodeGetContent(cur);
-                if (idVal == NULL)
-                    goto internal_error;
-                if (xmlAddIDSafe((xmlAttrPtr) cur, idVal) < 0) {
-                    xmlFree(idVal);
-                    goto internal_error;
-                }
-                xmlFree(idVal);
-	    }
-	}
-	/*
+/*
+* xmlTreeEnsureXMLDecl:
+* @doc: the doc
+*
+* Ensures that there is an XML namespace declaration on the doc.
+*
+* Returns the XML ns-struct or NULL if a memory allocation failed.
+*/
+static xmlNsPtr
+xmlTreeEnsureXMLDecl(xmlDocPtr doc)
+{
+    xmlNsPtr ns;
+
+    ns = doc->oldNs;
+    if (ns != NULL)
+	return (ns);
+
+    ns = xmlNewXmlNs(doc->dict);
+    doc->oldNs = ns;
+
+    return(ns);
+}
+
+/**
+ * Search for a namespace with `prefix` in scope of `node`.
+ *
+ * @param node  a node
+ * @param prefix  a namespace prefix
+ * @param out  pointer to resulting namespace
+ * @returns 0 on success, -1 if a memory allocation failed, 1 on
+ * other errors.
+ */
+int
+xmlSearchNsSafe(xmlNode *node, const xmlChar *prefix,
+                xmlNs **out) {
+    xmlNsPtr cur;
+    xmlDocPtr doc;
+    xmlNodePtr orig = node;
+    xmlNodePtr parent;
+
+    if (out == NULL)
+        return(1);
+    *out = NULL;
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
+        return(1);
+
+    doc = node->doc;
+
+    if ((doc != NULL) && (IS_STR_XML(prefix))) {
+        cur = xmlTreeEnsureXMLDecl(doc);
+        if (cur == NULL)
+            return(-1);
+        *out = cur;
+        return(0);
+    }
+
+    while (node->type != XML_ELEMENT_NODE) {
+        node = node->parent;
+        if (node == NULL)
+            return(0);
+    }
+
+    parent = node;
+
+    while ((node != NULL) && (node->type == XML_ELEMENT_NODE)) {
+        cur = node->nsDef;
+        while (cur != NULL) {
+            if ((xmlStrEqual(cur->prefix, prefix)) &&
+                (cur->href != NULL)) {
+                *out = cur;
+                return(0);
+            }
+            cur = cur->next;
+        }
+        if (orig != node) {
+            cur = node->ns;
+            if ((cur != NULL) &&
+                (xmlStrEqual(cur->prefix, prefix)) &&
+                (cur->href != NULL)) {
+                *out = cur;
+                return(0);
+            }
+        }
+
+	node = node->parent;
+    }
+
+    /*
+     * The XML-1.0 namespace is normally held on the document
+     * element. In this case exceptionally create it on the
+     * node element.
+     */
+    if ((doc == NULL) && (IS_STR_XML(prefix))) {
+        cur = xmlNewXmlNs(NULL);
+        if (cur == NULL)
+            return(-1);
+        cur->next = parent->nsDef;
+        parent->nsDef = cur;
+        *out = cur;
+    }
+
+    return(0);
+}
+
+/**
+ * Search for a namespace with `prefix` in scope of `node`.
+ *
+ * Recurse on the parents until it finds the defined namespace
+ * or return NULL otherwise.
+ *
+ * If `nameSpace` is NULL, the default namespace is looked up.
+ *
+ * Namespace search doesn't cross entity boundaries.
+ *
+ * @param doc  the document
+ * @param node  the current node
+ * @param nameSpace  the namespace prefix
+ * @returns the namespace pointer or NULL if no namespace was found or
+ * a memory allocation failed. Allocations can only fail if the `xml`
+ * namespace is queried.
+ */
+xmlNs *
+xmlSearchNs(xmlDoc *doc ATTRIBUTE_UNUSED, xmlNode *node,
+            const xmlChar *nameSpace) {
+    xmlNsPtr cur;
+
+    xmlSearchNsSafe(node, nameSpace, &cur);
+    return(cur);
+}
+
+/**
+ * Verify that the given namespace held on `ancestor` is still in scope
+ * on node.
+ *
+ * @param doc  the document
+ * @param node  the current node
+ * @param ancestor  the ancestor carrying the namespace
+ * @param prefix  the namespace prefix
+ * @returns 1 if true, 0 if false and -1 in case of error.
+ */
+static int
+xmlNsInScope(xmlDocPtr doc ATTRIBUTE_UNUSED, xmlNodePtr node,
+             xmlNodePtr ancestor, const xmlChar * prefix)
+{
+    xmlNsPtr tst;
+
+    while ((node != NULL) && (node != ancestor)) {
+        if ((node->type == XML_ENTITY_REF_NODE) ||
+            (node->type == XML_ENTITY_DECL))
+            return (-1);
+        if (node->type == XML_ELEMENT_NODE) {
+            tst = node->nsDef;
+            while (tst != NULL) {
+                if ((tst->prefix == NULL)
+                    && (prefix == NULL))
+                    return (0);
+                if ((tst->prefix != NULL)
+                    && (prefix != NULL)
+                    && (xmlStrEqual(tst->prefix, prefix)))
+                    return (0);
+                tst = tst->next;
+            }
+        }
+        node = node->parent;
+    }
+    if (node != ancestor)
+        return (-1);
+    return (1);
+}
+
+/**
+ * Search for a namespace matching `URI` in scope of `node`.
+ *
+ * @param node  a node
+ * @param href  a namespace URI
+ * @param out  pointer to resulting namespace
+ * @returns 0 on success, -1 if a memory allocation failed, 1 on
+ * other errors.
+ */
+int
+xmlSearchNsByHrefSafe(xmlNode *node, const xmlChar *href,
+                      xmlNs **out) {
+    xmlNsPtr cur;
+    xmlDocPtr doc;
+    xmlNodePtr orig = node;
+    xmlNodePtr parent;
+    int is_attr;
+
+    if (out == NULL)
+        return(1);
+    *out = NULL;
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
+        return(1);
+
+    doc = node->doc;
+
+    if ((doc != NULL) && (xmlStrEqual(href, XML_XML_NAMESPACE))) {
+        cur = xmlTreeEnsureXMLDecl(doc);
+        if (cur == NULL)
+            return(-1);
+        *out = cur;
+        return(0);
+    }
+
+    is_attr = (node->type == XML_ATTRIBUTE_NODE);
+
+    while (node->type != XML_ELEMENT_NODE) {
+        node = node->parent;
+        if (node == NULL)
+            return(0);
+    }
+
+    parent = node;
+
+    while ((node != NULL) && (node->type == XML_ELEMENT_NODE)) {
+        cur = node->nsDef;
+        while (cur != NULL) {
+            if (xmlStrEqual(cur->href, href)) {
+                if (((!is_attr) || (cur->prefix != NULL)) &&
+                    (xmlNsInScope(doc, orig, node, cur->prefix) == 1)) {
+                    *out = cur;
+                    return(0);
+                }
+            }
+            cur = cur->next;
+        }
+        if (orig != node) {
+            cur = node->ns;
+            if (cur != NULL) {
+                if (xmlStrEqual(cur->href, href)) {
+                    if (((!is_attr) || (cur->prefix != NULL)) &&
+                        (xmlNsInScope(doc, orig, node,
+                                      cur->prefix) == 1)) {
+                        *out = cur;
+                        return(0);
+                    }
+                }
+            }
+        }
+
+        node = node->parent;
+    }
+
+    /*
+     * The XML-1.0 namespace is normally held on the document
+     * element. In this case exceptionally create it on the
+     * node element.
+     */
+    if ((doc == NULL) && (xmlStrEqual(href, XML_XML_NAMESPACE))) {
+        cur = xmlNewXmlNs(NULL);
+        if (cur == NULL)
+            return(-1);
+        cur->next = parent->nsDef;
+        parent->nsDef = cur;
+        *out = cur;
+    }
+
+    return(0);
+}
+
+/**
+ * Search for a namespace matching `URI` in scope of `node`.
+ *
+ * @param doc  the document
+ * @param node  the current node
+ * @param href  the namespace value
+ * @returns the namespace pointer or NULL if no namespace was found or
+ * a memory allocation failed. Allocations can only fail if the `xml`
+ * namespace is queried.
+ */
+xmlNs *
+xmlSearchNsByHref(xmlDoc *doc ATTRIBUTE_UNUSED, xmlNode *node,
+                  const xmlChar * href) {
+    xmlNsPtr cur;
+
+    xmlSearchNsByHrefSafe(node, href, &cur);
+    return(cur);
+}
+
+/**
+ * Fix up namespace declarations.
+ *
+ * This function tries to locate a namespace definition in a tree
+ * ancestors, or create a new namespace definition node similar to
+ * `ns` trying to reuse the same prefix. However if the given prefix is
+ * null (default namespace) or reused within the subtree defined by
+ * `tree` or on one of its ancestors then a new prefix is generated.
+ *
+ * @param tree  a node expected to hold the new namespace
+ * @param ns  the original namespace
+ * @returns the (new) namespace definition or NULL in case of error
+ */
+static xmlNsPtr
+xmlNewReconciledNs(xmlNodePtr tree, xmlNsPtr ns) {
+    xmlNsPtr def;
+    xmlChar prefix[50];
+    int counter = 1;
+    int res;
+
+    if ((tree == NULL) || (tree->type != XML_ELEMENT_NODE)) {
+	return(NULL);
+    }
+    if ((ns == NULL) || (ns->type != XML_NAMESPACE_DECL)) {
+	return(NULL);
+    }
+    /*
+     * Search an existing namespace definition inherited.
+     */
+    res = xmlSearchNsByHrefSafe(tree, ns->href, &def);
+    if (res < 0)
+        return(NULL);
+    if (def != NULL)
+        return(def);
+
+    /*
+     * Find a close prefix which is not already in use.
+     * Let's strip namespace prefixes longer than 20 chars !
+     */
+    if (ns->prefix == NULL)
+	snprintf((char *) prefix, sizeof(prefix), "default");
+    else
+	snprintf((char *) prefix, sizeof(prefix), "%.20s", (char *)ns->prefix);
+
+    res = xmlSearchNsSafe(tree, prefix, &def);
+    if (res < 0)
+        return(NULL);
+    while (def != NULL) {
+        if (counter > 1000) return(NULL);
+	if (ns->prefix == NULL)
+	    snprintf((char *) prefix, sizeof(prefix), "default%d", counter++);
+	else
+	    snprintf((char *) prefix, sizeof(prefix), "%.20s%d",
+		(char *)ns->prefix, counter++);
+	res = xmlSearchNsSafe(tree, prefix, &def);
+        if (res < 0)
+            return(NULL);
+    }
+
+    /*
+     * OK, now we are ready to create a new one.
+     */
+    def = xmlNewNs(tree, ns->href, prefix);
+    return(def);
+}
+
+typedef struct {
+    xmlNsPtr oldNs;
+    xmlNsPtr newNs;
+} xmlNsCache;
+
+/*
+ * Returns the slot of `oldNs` in the open addressing table `cache`
+ * of size `size`, a power of two.
+ */
+static int
+xmlNsCacheIndex(const xmlNsCache *cache, int size, xmlNsPtr oldNs) {
+    size_t v = (size_t) oldNs;
+    unsigned int i;
+
+    i = (unsigned int) ((v >> 4) ^ (v >> 20)) * 2654435761u;
+    i = (i ^ (i >> 16)) & (size - 1);
+    while ((cache[i].oldNs != NULL) && (cache[i].oldNs != oldNs))
+        i = (i + 1) & (size - 1);
+
+    return(i);
+}
+
+static int
+xmlNsCacheAdd(xmlNsCache **cache, int *capacity, int *number,
+              xmlNsPtr oldNs, xmlNsPtr newNs) {
+    int i;
+
+    if (*number * 2 >= *capacity) {
+        xmlNsCache *tmp;
+        int newSize = (*capacity > 0) ? *capacity * 2 : 16;
+
+        if (*capacity > XML_MAX_ITEMS)
+            return(-1);
+        tmp = xmlMalloc(newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        memset(tmp, 0, newSize * sizeof(tmp[0]));
+        for (i = 0; i < *capacity; i++) {
+            if ((*cache)[i].oldNs != NULL)
+                tmp[xmlNsCacheIndex(tmp, newSize, (*cache)[i].oldNs)] =
+                    (*cache)[i];
+        }
+        xmlFree(*cache);
+        *cache = tmp;
+        *capacity = newSize;
+    }
+
+    i = xmlNsCacheIndex(*cache, *capacity, oldNs);
+    (*cache)[i].oldNs = oldNs;
+    (*cache)[i].newNs = newNs;
+    (*number)++;
+
+    return(0);
+}
+
+/**
+ * This function checks that all the namespaces declared within the given
+ * tree are properly declared. This is needed for example after copy or cut
+ * and then paste operations. The subtree may still hold pointers to
+ * namespace declarations outside the subtree or invalid/masked. As much
+ * as possible the function tries to reuse the existing namespaces found in
+ * the new environment. If not possible the new namespaces are redeclared
+ * on `tree` at the top of the given subtree.
+ *
+ * @param doc  the document
+ * @param tree  a node defining the subtree to reconciliate
+ * @returns 0 on success or -1 in case of error.
+ */
+int
+xmlReconciliateNs(xmlDoc *doc, xmlNode *tree) {
+    xmlNsCache *cache = NULL;
+    int sizeCache = 0;
+    int nbCache = 0;
+
+    xmlNsPtr n;
+    xmlNodePtr node = tree;
+    xmlAttrPtr attr;
+    int ret = 0, i;
+
+    if ((node == NULL) || (node->type != XML_ELEMENT_NODE)) return(-1);
+    if (node->doc != doc) return(-1);
+    while (node != NULL) {
+        /*
+	 * Reconciliate the node namespace
+	 */
+	if (node->ns != NULL) {
+            i = (nbCache > 0) ?
+                xmlNsCacheIndex(cache, sizeCache, node->ns) : -1;
+	    if ((i >= 0) && (cache[i].oldNs != NULL)) {
+                xmlNodeSourceChanged(node);
+		node->ns = cache[i].newNs;
+	    } else {
+	        /*
+		 * OK we need to recreate a new namespace definition
+		 */
+		n = xmlNewReconciledNs(tree, node->ns);
+		if (n == NULL) {
+                    ret = -1;
+                } else {
+		    if (xmlNsCacheAdd(&cache, &sizeCache, &nbCache,
+                                      node->ns, n) < 0)
+                        ret = -1;
+                }
+                xmlNodeSourceChanged(node);
+		node->ns = n;
+	    }
+	}
+	/*
+	 * now check for namespace held by attributes on the node.
+	 */
+	if (node->type == XML_ELEMENT_NODE) {
+	    attr = node->properties;
+	    while (attr != NULL) {
+		if (attr->ns != NULL) {
+                    i = (nbCache > 0) ?
+                        xmlNsCacheIndex(cache, sizeCache, attr->ns) : -1;
+		    if ((i >= 0) && (cache[i].oldNs != NULL)) {
+                        xmlNodeSourceChanged(node);
+			attr->ns = cache[i].newNs;
+		    } else {
+			/*
+			 * OK we need to recreate a new namespace definition
+			 */
+			n = xmlNewReconciledNs(tree, attr->ns);
+			if (n == NULL) {
+                            ret = -1;
+                        } else {
+                            if (xmlNsCacheAdd(&cache, &sizeCache, &nbCache,
+                                              attr->ns, n) < 0)
+                                ret = -1;
+			}
+                        xmlNodeSourceChanged(node);
+			attr->ns = n;
+		    }
+		}
+		attr = attr->next;
+	    }
+	}
+
+	/*
+	 * Browse the full subtree, deep first
+	 */
+        if ((node->children != NULL) && (node->type != XML_ENTITY_REF_NODE)) {
+	    /* deep first */
+	    node = node->children;
+	} else if ((node != tree) && (node->next != NULL)) {
+	    /* then siblings */
+	    node = node->next;
+	} else if (node != tree) {
+	    /* go up to parents->next if needed */
+	    while (node != tree) {
+	        if (node->parent != NULL)
+		    node = node->parent;
+		if ((node != tree) && (node->next != NULL)) {
+		    node = node->next;
+		    break;
+		}
+		if (node->parent == NULL) {
+		    node = NULL;
+		    break;
+		}
+	    }
+	    /* exit condition */
+	    if (node == tree)
+	        node = NULL;
+	} else
+	    break;
+    }
+    if (cache != NULL)
+	xmlFree(cache);
+    return(ret);
+}
+
+static xmlAttrPtr
+xmlGetPropNodeInternal(const xmlNode *node, const xmlChar *name,
+		       const xmlChar *nsName, int useDTD)
+{
+    xmlAttrPtr prop;
+
+    /* Avoid unused variable warning if features are disabled. */
+    (void) useDTD;
+
+    if ((node == NULL) || (node->type != XML_ELEMENT_NODE) || (name == NULL))
+	return(NULL);
+
+    if (node->properties != NULL) {
+	prop = node->properties;
+	if (nsName == NULL) {
+	    /*
+	    * We want the attr to be in no namespace.
+	    */
+	    do {
+		if ((prop->ns == NULL) && xmlStrEqual(prop->name, name)) {
+		    return(prop);
+		}
+		prop = prop->next;
+	    } while (prop != NULL);
+	} else {
+	    /*
+	    * We want the attr to be in the specified namespace.
+	    */
+	    do {
+		if ((prop->ns != NULL) && xmlStrEqual(prop->name, name) &&
+		    ((prop->ns->href == nsName) ||
+		     xmlStrEqual(prop->ns->href, nsName)))
+		{
+		    return(prop);
+		}
+		prop = prop->next;
+	    } while (prop != NULL);
+	}
+    }
+
+    if (! useDTD)
+	return(NULL);
+    /*
+     * Check if there is a default/fixed attribute declaration in
+     * the internal or external subset.
+     */
+    if ((node->doc != NULL) && (node->doc->intSubset != NULL)) {
+	xmlDocPtr doc = node->doc;
+	xmlAttributePtr attrDecl = NULL;
+	xmlChar *elemQName, *tmpstr = NULL;
+
+	/*
+	* We need the QName of the element for the DTD-lookup.
+	*/
+	if ((node->ns != NULL) && (node->ns->prefix != NULL)) {
+	    tmpstr = xmlStrdup(node->ns->prefix);
+	    if (tmpstr == NULL)
+		return(NULL);
+	    tmpstr = xmlStrcat(tmpstr, BAD_CAST ":");
+	    if (tmpstr == NULL)
+		return(NULL);
+	    tmpstr = xmlStrcat(tmpstr, node->name);
+	    if (tmpstr == NULL)
+		return(NULL);
+	    elemQName = tmpstr;
+	} else
+	    elemQName = (xmlChar *) node->name;
+	if (nsName == NULL) {
+	    /*
+	    * The common and nice case: Attr in no namespace.
+	    */
+	    attrDecl = xmlGetDtdQAttrDesc(doc->intSubset,
+		elemQName, name, NULL);
+	    if ((attrDecl == NULL) && (doc->extSubset != NULL)) {
+		attrDecl = xmlGetDtdQAttrDesc(doc->extSubset,
+		    elemQName, name, NULL);
+	    }
+        } else if (xmlStrEqual(nsName, XML_XML_NAMESPACE)) {
+	    /*
+	    * The XML namespace must be bound to prefix 'xml'.
+	    */
+	    attrDecl = xmlGetDtdQAttrDesc(doc->intSubset,
+		elemQName, name, BAD_CAST "xml");
+	    if ((attrDecl == NULL) && (doc->extSubset != NULL)) {
+		attrDecl = xmlGetDtdQAttrDesc(doc->extSubset,
+		    elemQName, name, BAD_CAST "xml");
+	    }
+	} else {
+	    xmlNsPtr *nsList, *cur;
+
+	    /*
+	    * The ugly case: Search using the prefixes of in-scope
+	    * ns-decls corresponding to @nsName.
+	    */
+	    nsList = xmlGetNsList(node->doc, node);
+	    if (nsList == NULL) {
+		if (tmpstr != NULL)
+		    xmlFree(tmpstr);
+		return(NULL);
+	    }
+	    cur = nsList;
+	    while (*cur != NULL) {
+		if (xmlStrEqual((*cur)->href, nsName)) {
+		    attrDecl = xmlGetDtdQAttrDesc(doc->intSubset, elemQName,
+			name, (*cur)->prefix);
+		    if (attrDecl)
+			break;
+		    if (doc->extSubset != NULL) {
+			attrDecl = xmlGetDtdQAttrDesc(doc->extSubset, elemQName,
+			    name, (*cur)->prefix);
+			if (attrDecl)
+			    break;
+		    }
+		}
+		cur++;
+	    }
+	    xmlFree(nsList);
+	}
+	if (tmpstr != NULL)
+	    xmlFree(tmpstr);
+	/*
+	* Only default/fixed attrs are relevant.
+	*/
+	if ((attrDecl != NULL) && (attrDecl->defaultValue != NULL))
+	    return((xmlAttrPtr) attrDecl);
+    }
+
+    return(NULL);
+}
+
+static xmlChar*
+xmlGetPropNodeValueInternal(const xmlAttr *prop)
+{
+    if (prop == NULL)
+	return(NULL);
+    if (prop->type == XML_ATTRIBUTE_NODE) {
+	return(xmlNodeGetContent((xmlNodePtr) prop));
+    } else if (prop->type == XML_ATTRIBUTE_DECL) {
+	return(xmlStrdup(((xmlAttributePtr)prop)->defaultValue));
+    }
+    return(NULL);
+}
+
+/**
+ * Search for an attribute of an element.
+ *
+ * This function also looks in DTD attribute declaration for \#FIXED or
+ * default declaration values.
+ *
+ * @param node  the element
+ * @param name  the attribute name
+ * @returns the attribute or the attribute declaration or NULL if
+ * neither was found. Also returns NULL if a memory allocation failed,
+ * making this function unreliable.
+ */
+xmlAttr *
+xmlHasProp(const xmlNode *node, const xmlChar *name) {
+    xmlAttrPtr prop;
+    xmlDocPtr doc;
+
+    if ((node == NULL) || (node->type != XML_ELEMENT_NODE) || (name == NULL))
+        return(NULL);
+    /*
+     * Check on the properties attached to the node
+     */
+    prop = node->properties;
+    while (prop != NULL) {
+        if (xmlStrEqual(prop->name, name))  {
+	    return(prop);
+        }
+	prop = prop->next;
+    }
+
+    /*
+     * Check if there is a default declaration in the internal
+     * or external subsets
+     */
+    doc =  node->doc;
+    if (doc != NULL) {
+        xmlAttributePtr attrDecl;
+        if (doc->intSubset != NULL) {
+	    attrDecl = xmlGetDtdAttrDesc(doc->intSubset, node->name, name);
+	    if ((attrDecl == NULL) && (doc->extSubset != NULL))
+		attrDecl = xmlGetDtdAttrDesc(doc->extSubset, node->name, name);
+            if ((attrDecl != NULL) && (attrDecl->defaultValue != NULL))
+              /* return attribute declaration only if a default value is given
+                 (that includes #FIXED declarations) */
+		return((xmlAttrPtr) attrDecl);
+	}
+    }
+    return(NULL);
+}
+
+/**
+ * Search for an attribute of an element.
+ *
+ * The attribute has to match the specified namespace. A namespace of
+ * NULL means that the attribute must have no namespace.
+ *
+ * This function also looks in DTD attribute declaration for \#FIXED or
+ * default declaration values.
+ *
+ * @param node  the element
+ * @param name  the attribute name
+ * @param nameSpace  the URI of the namespace
+ * @returns the attribute or the attribute declaration or NULL if
+ * neither was found. Also returns NULL if a memory allocation failed
+ * making this function unreliable.
+ */
+xmlAttr *
+xmlHasNsProp(const xmlNode *node, const xmlChar *name, const xmlChar *nameSpace) {
+
+    return(xmlGetPropNodeInternal(node, name, nameSpace, 1));
+}
+
+/**
+ * Look up the value of an element's attribute.
+ *
+ * The attribute has to match the specified namespace. A namespace of
+ * NULL means that the attribute must have no namespace.
+ *
+ * Entities are substituted. The returned value must be freed by the
+ * caller.
+ *
+ * @since 2.13.0
+ *
+ * @param node  the element
+ * @param name  the attribute name
+ * @param nsUri  the URI of the namespace
+ * @param out  the returned string
+ * @returns 0 on success, 1 if no attribute was found, -1 if a
+ * memory allocation failed.
+ */
+int
+xmlNodeGetAttrValue(const xmlNode *node, const xmlChar *name,
+                    const xmlChar *nsUri, xmlChar **out) {
+    xmlAttrPtr prop;
+
+    if (out == NULL)
+        return(1);
+    *out = NULL;
+
+    prop = xmlGetPropNodeInternal(node, name, nsUri, 0);
+    if (prop == NULL)
+	return(1);
+
+    *out = xmlGetPropNodeValueInternal(prop);
+    if (*out == NULL)
+        return(-1);
+    return(0);
+}
+
+/**
+ * Look up the value of an element's attribute.
+ *
+ * Entities are substituted. The returned value must be freed by the
+ * caller.
+ *
+ * This function looks in DTD attribute declarations for \#FIXED or
+ * default declaration values.
+ *
+ * NOTE: This function is ignores namespaces. Use #xmlGetNsProp or
+ * #xmlGetNoNsProp for namespace aware processing.
+ *
+ * NOTE: This function doesn't allow to distinguish malloc failures from
+ * missing attributes.
+ *
+ * @param node  the element
+ * @param name  the attribute name
+ * @returns the attribute value or NULL if not found or a memory allocation
+ * failed.
+ */
+xmlChar *
+xmlGetProp(const xmlNode *node, const xmlChar *name) {
+    xmlAttrPtr prop;
+
+    prop = xmlHasProp(node, name);
+    if (prop == NULL)
+	return(NULL);
+    return(xmlGetPropNodeValueInternal(prop));
+}
+
+/**
+ * Look up the value of an element's attribute.
+ *
+ * Entities are substituted. The returned value must be freed by the
+ * caller.
+ *
+ * This function looks in DTD attribute declarations for \#FIXED or
+ * default declaration values.
+ *
+ * This function is similar to #xmlGetProp except it will accept only
+ * an attribute in no namespace.
+ *
+ * NOTE: This function doesn't allow to distinguish malloc failures from
+ * missing attributes. It's more robust to use #xmlNodeGetAttrValue.
+ *
+ * @param node  the element
+ * @param name  the attribute name
+ * @returns the attribute value or NULL if not found or a memory allocation
+ * failed.
+ */
+xmlChar *
+xmlGetNoNsProp(const xmlNode *node, const xmlChar *name) {
+    xmlAttrPtr prop;
+
+    prop = xmlGetPropNodeInternal(node, name, NULL, 1);
+    if (prop == NULL)
+	return(NULL);
+    return(xmlGetPropNodeValueInternal(prop));
+}
+
+/**
+ * Look up the value of an element's attribute.
+ *
+ * The attribute has to match the specified namespace. A namespace of
+ * NULL means that the attribute must have no namespace.
+ *
+ * Entities are substituted. The returned value must be freed by the
+ * caller.
+ *
+ * This function looks in DTD attribute declaration for \#FIXED or
+ * default declaration values.
+ *
+ * NOTE: This function doesn't allow to distinguish malloc failures from
+ * missing attributes. It's more robust to use #xmlNodeGetAttrValue.
+ *
+ * @param node  the element
+ * @param name  the attribute name
+ * @param nameSpace  the URI of the namespace
+ * @returns the attribute value or NULL if not found or a memory allocation
+ * failed.
+ */
+xmlChar *
+xmlGetNsProp(const xmlNode *node, const xmlChar *name, const xmlChar *nameSpace) {
+    xmlAttrPtr prop;
+
+    prop = xmlGetPropNodeInternal(node, name, nameSpace, 1);
+    if (prop == NULL)
+	return(NULL);
+    return(xmlGetPropNodeValueInternal(prop));
+}
+
+/**
+ * Remove an attribute of an element.
+ * This handles only attributes in no namespace.
+ *
+ * @param node  the element
+ * @param name  the attribute name
+ * @returns 0 if successful, -1 if not found
+ */
+int
+xmlUnsetProp(xmlNode *node, const xmlChar *name) {
+    xmlAttrPtr prop;
+
+    prop = xmlGetPropNodeInternal(node, name, NULL, 0);
+    if (prop == NULL)
+	return(-1);
+    xmlUnlinkNodeInternal((xmlNodePtr) prop);
+    xmlFreeProp(prop);
+    return(0);
+}
+
+/**
+ * Remove an attribute of an element.
+ *
+ * @param node  the element
+ * @param ns  the namespace definition
+ * @param name  the attribute name
+ * @returns 0 if successful, -1 if not found
+ */
+int
+xmlUnsetNsProp(xmlNode *node, xmlNs *ns, const xmlChar *name) {
+    xmlAttrPtr prop;
+
+    prop = xmlGetPropNodeInternal(node, name,
+                                  (ns != NULL) ? ns->href : NULL, 0);
+    if (prop == NULL)
+	return(-1);
+    xmlUnlinkNodeInternal((xmlNodePtr) prop);
+    xmlFreeProp(prop);
+    return(0);
+}
+
+/**
+ * Set (or reset) an element's attribute. If `name` has a prefix,
+ * the corresponding namespace will be used. It is an error if
+ * there's no such binding for the prefix in scope.
+ *
+ * @param node  the node
+ * @param name  the attribute name (a QName)
+ * @param value  the attribute value
+ * @returns the attribute pointer.
+ */
+xmlAttr *
+xmlSetProp(xmlNode *node, const xmlChar *name, const xmlChar *value) {
+    xmlNsPtr ns = NULL;
+    const xmlChar *localname;
+    xmlChar *prefix;
+    int res;
+
+    if ((node == NULL) || (name == NULL) || (node->type != XML_ELEMENT_NODE))
+	return(NULL);
+
+    /*
+     * handle QNames
+     */
+    localname = xmlSplitQName4(name, &prefix);
+    if (localname == NULL)
+        return(NULL);
+
+    if (prefix != NULL) {
+	res = xmlSearchNsSafe(node, prefix, &ns);
+	xmlFree(prefix);
+        if (res < 0)
+            return(NULL);
+        if (ns != NULL)
+            return(xmlSetNsProp(node, ns, localname, value));
+    }
+
+    return(xmlSetNsProp(node, NULL, name, value));
+}
+
+/**
+ * Set (or reset) an element's attribute.
+ *
+ * The namespace must be in scope.
+ *
+ * @param node  the node
+ * @param ns  the namespace definition
+ * @param name  the attribute name
+ * @param value  the attribute value
+ * @returns the attribute pointer.
+ */
+xmlAttr *
+xmlSetNsProp(xmlNode *node, xmlNs *ns, const xmlChar *name,
+	     const xmlChar *value)
+{
+    xmlAttrPtr prop;
+
+    if (ns && (ns->href == NULL))
+	return(NULL);
+    if (name == NULL)
+        return(NULL);
+    prop = xmlGetPropNodeInternal(node, name,
+                                  (ns != NULL) ? ns->href : NULL, 0);
+    if (prop != NULL) {
+        xmlNodePtr children = NULL;
+
+	/*
+	* Modify the attribute's value.
+	*/
+        xmlDocIndexAttrChanged((xmlNodePtr) prop);
+        xmlNodeSourceChanged(node);
+        if (value != NULL) {
+	    children = xmlNewDocText(node->doc, value);
+            if (children == NULL)
+                return(NULL);
+        }
+
+	if (prop->id != NULL) {
+	    xmlRemoveID(node->doc, prop);
+	    prop->atype = XML_ATTRIBUTE_ID;
+	}
+	if (prop->children != NULL)
+	    xmlFreeNodeList(prop->children);
+	prop->children = NULL;
+	prop->last = NULL;
+	prop->ns = ns;
+	if (value != NULL) {
+	    xmlNodePtr tmp;
+
+	    prop->children = children;
+	    prop->last = NULL;
+	    tmp = prop->children;
+	    while (tmp != NULL) {
+		tmp->parent = (xmlNodePtr) prop;
+		if (tmp->next == NULL)
+		    prop->last = tmp;
+		tmp = tmp->next;
+	    }
+	}
+	if ((prop->atype == XML_ATTRIBUTE_ID) &&
+	    (xmlAddIDSafe(prop, value) < 0)) {
+            return(NULL);
+        }
+	return(prop);
+    }
+    /*
+    * No equal attr found; create a new one.
+    */
+    return(xmlNewPropInternal(node, ns, name, value, 0));
+}
+
+/**
+ * Check whether the node is a text node.
+ *
+ * @param node  the node
+ * @returns 1 if yes, 0 if no
+ */
+int
+xmlNodeIsText(const xmlNode *node) {
+    if (node == NULL) return(0);
+
+    if (node->type == XML_TEXT_NODE) return(1);
+    return(0);
+}
+
+/**
+ * Checks whether this node is an empty or whitespace-only
+ * text node.
+ *
+ * @param node  the node
+ * @returns 1 if yes, 0 if no
+ */
+int
+xmlIsBlankNode(const xmlNode *node) {
+    const xmlChar *cur;
+    if (node == NULL) return(0);
+
+    if ((node->type != XML_TEXT_NODE) &&
+        (node->type != XML_CDATA_SECTION_NODE))
+	return(0);
+    if (node->content == NULL) return(1);
+    cur = node->content;
+    while (*cur != 0) {
+	if (!IS_BLANK_CH(*cur)) return(0);
+	cur++;
+    }
+
+    return(1);
+}
+
+/**
+ * Concat the given string at the end of the existing node content.
+ *
+ * If `len` is -1, the string length will be calculated.
+ *
+ * @param node  the node
+ * @param content  the content
+ * @param len  `content` length
+ * @returns -1 in case of error, 0 otherwise
+ */
+
+int
+xmlTextConcat(xmlNode *node, const xmlChar *content, int len) {
+    if (node == NULL)
+        return(-1);
+
+    if ((node->type != XML_TEXT_NODE) &&
+        (node->type != XML_CDATA_SECTION_NODE) &&
+	(node->type != XML_COMMENT_NODE) &&
+	(node->type != XML_PI_NODE))
+        return(-1);
+
+    return(xmlTextAddContent(node, content, len));
+}
+
+/**
+ * Get the compression level of a document, ZLIB based.
+ *
+ * @param doc  the document
+ * @returns 0 (uncompressed) to 9 (max compression)
+ */
+int
+xmlGetDocCompressMode (const xmlDoc *doc) {
+    if (doc == NULL) return(-1);
+    return(doc->compression);
+}
+
+/**
+ * Set the compression level of a document, ZLIB based.
+ *
+ * Correct values: 0 (uncompressed) to 9 (max compression)
+ *
+ * @param doc  the document
+ * @param mode  the compression ratio
+ */
+void
+xmlSetDocCompressMode (xmlDoc *doc, int mode) {
+    if (doc == NULL) return;
+    if (mode < 0) doc->compression = 0;
+    else if (mode > 9) doc->compression = 9;
+    else doc->compression = mode;
+}
+
+/**
+ * Get the global compression level, ZLIB based.
+ *
+ * @deprecated Use #xmlGetDocCompressMode
+ *
+ * @returns 0 (uncompressed) to 9 (max compression)
+ */
+int
+xmlGetCompressMode(void)
+{
+    return (xmlCompressMode);
+}
+
+/**
+ * Set the global compression level, ZLIB based.
+ *
+ * @deprecated Use #xmlSetDocCompressMode
+ *
+ * Correct values: 0 (uncompressed) to 9 (max compression)
+ *
+ * @param mode  the compression ratio
+ */
+void
+xmlSetCompressMode(int mode) {
+    if (mode < 0) xmlCompressMode = 0;
+    else if (mode > 9) xmlCompressMode = 9;
+    else xmlCompressMode = mode;
+}
+
+#define XML_TREE_NSMAP_PARENT -1
+#define XML_TREE_NSMAP_XML -2
+#define XML_TREE_NSMAP_DOC -3
+#define XML_TREE_NSMAP_CUSTOM -4
+
+typedef struct xmlNsMapItem *xmlNsMapItemPtr;
+struct xmlNsMapItem {
+    xmlNsMapItemPtr next;
+    xmlNsMapItemPtr prev;
+    xmlNsPtr oldNs; /* old ns decl reference */
+    xmlNsPtr newNs; /* new ns decl reference */
+    int shadowDepth; /* Shadowed at this depth */
+    /*
+    * depth:
+    * >= 0 == @node's ns-decls
+    * -1   == @parent's ns-decls
+    * -2   == the doc->oldNs XML ns-decl
+    * -3   == the doc->oldNs storage ns-decls
+    * -4   == ns-decls provided via custom ns-handling
+    */
+    int depth;
+};
+
+typedef struct {
+    xmlNsPtr oldNs;
+    xmlNsMapItemPtr item;
+} xmlNsMapIndexEntry;
+
+typedef struct xmlNsMap *xmlNsMapPtr;
+struct xmlNsMap {
+    xmlNsMapItemPtr first;
+    xmlNsMapItemPtr last;
+    xmlNsMapItemPtr pool;
+    /*
+    * Hash index of ns-references, see xmlDOMWrapNsMapLookup. It's
+    * rebuilt on demand if @gen changed since @indexGen.
+    */
+    xmlNsMapIndexEntry *index;
+    int indexSize;
+    unsigned gen;
+    unsigned indexGen;
+    int nbItems;
+    int nbShadowed; /* number of items with a shadowDepth */
+};
+
+#define XML_NSMAP_NOTEMPTY(m) (((m) != NULL) && ((m)->first != NULL))
+#define XML_NSMAP_FOREACH(m, i) for (i = (m)->first; i != NULL; i = (i)->next)
+
+/**
+ * Frees the ns-map
+ *
+ * @param nsmap  the ns-map
+ */
+static void
+xmlDOMWrapNsMapFree(xmlNsMapPtr nsmap)
+{
+    xmlNsMapItemPtr cur, tmp;
+
+    if (nsmap == NULL)
+	return;
+    cur = nsmap->pool;
+    while (cur != NULL) {
+	tmp = cur;
+	cur = cur->next;
+	xmlFree(tmp);
+    }
+    cur = nsmap->first;
+    while (cur != NULL) {
+	tmp = cur;
+	cur = cur->next;
+	xmlFree(tmp);
+    }
+    xmlFree(nsmap->index);
+    xmlFree(nsmap);
+}
+
+/**
+ * Adds an ns-mapping item.
+ *
+ * @param nsmap  the ns-map
+ * @param position  position
+ * @param oldNs  the old ns-struct
+ * @param newNs  the new ns-struct
+ * @param depth  depth and ns-kind information
+ * @returns the added item.
+ */
+static xmlNsMapItemPtr
+xmlDOMWrapNsMapAddItem(xmlNsMapPtr *nsmap, int position,
+		       xmlNsPtr oldNs, xmlNsPtr newNs, int depth)
+{
+    xmlNsMapItemPtr ret;
+    xmlNsMapPtr map;
+
+    if (nsmap == NULL)
+	return(NULL);
+    if ((position != -1) && (position != 0))
+	return(NULL);
+    map = *nsmap;
+
+    if (map == NULL) {
+	/*
+	* Create the ns-map.
+	*/
+	map = (xmlNsMapPtr) xmlMalloc(sizeof(struct xmlNsMap));
+	if (map == NULL)
+	    return(NULL);
+	memset(map, 0, sizeof(struct xmlNsMap));
+	*nsmap = map;
+    }
+
+    if (map->pool != NULL) {
+	/*
+	* Reuse an item from the pool.
+	*/
+	ret = map->pool;
+	map->pool = ret->next;
+	memset(ret, 0, sizeof(struct xmlNsMapItem));
+    } else {
+	/*
+	* Create a new item.
+	*/
+	ret = (xmlNsMapItemPtr) xmlMalloc(sizeof(struct xmlNsMapItem));
+	if (ret == NULL)
+	    return(NULL);
+	memset(ret, 0, sizeof(struct xmlNsMapItem));
+    }
+
+    if (map->first == NULL) {
+	/*
+	* First ever.
+	*/
+	map->first = ret;
+	map->last = ret;
+    } else if (position == -1) {
+	/*
+	* Append.
+	*/
+	ret->prev = map->last;
+	map->last->next = ret;
+	map->last = ret;
+    } else if (position == 0) {
+	/*
+	* Set on first position.
+	*/
+	map->first->prev = ret;
+	ret->next = map->first;
+	map->first = ret;
+    }
+
+    ret->oldNs = oldNs;
+    ret->newNs = newNs;
+    ret->shadowDepth = -1;
+    ret->depth = depth;
+    map->nbItems++;
+    map->gen++;
+    return (ret);
+}
+
+/**
+ * Marks an ns-mapping item as shadowed.
+ *
+ * @param map  the ns-map
+ * @param mi  the item
+ * @param depth  the depth of the shadowing ns-decl
+ */
+static void
+xmlDOMWrapNsMapShadow(xmlNsMapPtr map, xmlNsMapItemPtr mi, int depth)
+{
+    if (mi->shadowDepth == -1)
+        map->nbShadowed++;
+    mi->shadowDepth = depth;
+    map->gen++;
+}
+
+/**
+ * Removes the ns-mapping items of ns-decls at or below `depth` and
+ * unshadows the items shadowed by them.
+ *
+ * @param map  the ns-map
+ * @param depth  the depth of the element which is left
+ */
+static void
+xmlDOMWrapNsMapPop(xmlNsMapPtr map, int depth)
+{
+    xmlNsMapItemPtr mi;
+
+    while ((map->last != NULL) && (map->last->depth >= depth)) {
+        mi = map->last;
+        map->last = mi->prev;
+        if (map->last == NULL)
+            map->first = NULL;
+        else
+            map->last->next = NULL;
+        if (mi->shadowDepth != -1)
+            map->nbShadowed--;
+        map->nbItems--;
+        mi->next = map->pool;
+        map->pool = mi;
+        map->gen++;
+    }
+
+    if (map->nbShadowed > 0) {
+        XML_NSMAP_FOREACH(map, mi) {
+            if (mi->shadowDepth >= depth) {
+                mi->shadowDepth = -1;
+                map->nbShadowed--;
+                map->gen++;
+            }
+        }
+    }
+}
+
+static int
+xmlDOMWrapNsMapIndexSlot(const xmlNsMapIndexEntry *index, int size,
+                         xmlNsPtr oldNs)
+{
+    size_t v = (size_t) oldNs;
+    unsigned int i;
+
+    i = (unsigned int) ((v >> 4) ^ (v >> 20)) * 2654435761u;
+    i = (i ^ (i >> 16)) & (size - 1);
+    while ((index[i].oldNs != NULL) && (index[i].oldNs != oldNs))
+        i = (i + 1) & (size - 1);
+    return (i);
+}
+
+/**
+ * Finds the first unshadowed mapping of a ns-reference.
+ *
+ * The mappings are indexed by `oldNs` in a hash table which is rebuilt
+ * when the map changed, so repeated references to the same ns-decls
+ * don't scan the whole map. If the index can't be allocated, the map
+ * is searched linearly.
+ *
+ * @param map  the ns-map
+ * @param oldNs  the ns-reference to map
+ * @returns the item or NULL if there's no mapping.
+ */
+static xmlNsMapItemPtr
+xmlDOMWrapNsMapLookup(xmlNsMapPtr map, xmlNsPtr oldNs)
+{
+    xmlNsMapItemPtr mi;
+    int i;
+
+    if ((map->index == NULL) || (map->indexGen != map->gen)) {
+        int size = (map->indexSize > 0) ? map->indexSize : 16;
+
+        while ((size / 2 <= map->nbItems) && (size < XML_MAX_ITEMS))
+            size *= 2;
+        if (size != map->indexSize) {
+            xmlFree(map->index);
+            map->indexSize = 0;
+            map->index = xmlMalloc(size * sizeof(map->index[0]));
+            if (map->index == NULL)
+                goto linear;
+            map->indexSize = size;
+        }
+        memset(map->index, 0, size * sizeof(map->index[0]));
+
+        XML_NSMAP_FOREACH(map, mi) {
+            if ((mi->shadowDepth != -1) || (mi->oldNs == NULL))
+                continue;
+            i = xmlDOMWrapNsMapIndexSlot(map->index, size, mi->oldNs);
+            if (map->index[i].oldNs == NULL) {
+                map->index[i].oldNs = mi->oldNs;
+                map->index[i].item = mi;
+            }
+        }
+        map->indexGen = map->gen;
+    }
+
+    i = xmlDOMWrapNsMapIndexSlot(map->index, map->indexSize, oldNs);
+    return (map->index[i].item);
+
+linear:
+    XML_NSMAP_FOREACH(map, mi) {
+        if ((mi->shadowDepth == -1) && (mi->oldNs == oldNs))
+            return (mi);
+    }
+    return (NULL);
+}
+
+/**
+ * Creates or reuses an xmlNs struct on doc->oldNs with
+ * the given prefix and namespace name.
+ *
+ * @param doc  the doc
+ * @param nsName  the namespace name
+ * @param prefix  the prefix
+ * @returns the acquired ns struct or NULL in case of an API
+ *          or internal error.
+ */
+static xmlNsPtr
+xmlDOMWrapStoreNs(xmlDocPtr doc,
+		   const xmlChar *nsName,
+		   const xmlChar *prefix)
+{
+    xmlNsPtr ns;
+
+    if (doc == NULL)
+	return (NULL);
+    ns = xmlTreeEnsureXMLDecl(doc);
+    if (ns == NULL)
+	return (NULL);
+    if (ns->next != NULL) {
+	/* Reuse. */
+	ns = ns->next;
+	while (ns != NULL) {
+	    if (((ns->prefix == prefix) ||
+		xmlStrEqual(ns->prefix, prefix)) &&
+		xmlStrEqual(ns->href, nsName)) {
+		return (ns);
+	    }
+	    if (ns->next == NULL)
+		break;
+	    ns = ns->next;
+	}
+    }
+    /* Create. */
+    if (ns != NULL) {
+        ns->next = xmlNewNs(NULL, nsName, prefix);
+        if (ns->next != NULL)
+            xmlDictNsId(doc->dict, nsName, 1);
+        return (ns->next);
+    }
+    return(NULL);
+}
+
+/**
+ * Allocates and initializes a new DOM-wrapper context.
+ *
+ * @returns the xmlDOMWrapCtxt or NULL in case of an internal error.
+ */
+xmlDOMWrapCtxt *
+xmlDOMWrapNewCtxt(void)
+{
+    xmlDOMWrapCtxtPtr ret;
+
+    ret = xmlMalloc(sizeof(xmlDOMWrapCtxt));
+    if (ret == NULL)
+	return (NULL);
+    memset(ret, 0, sizeof(xmlDOMWrapCtxt));
+    return (ret);
+}
+
+/**
+ * Frees the DOM-wrapper context.
+ *
+ * @param ctxt  the DOM-wrapper context
+ */
+void
+xmlDOMWrapFreeCtxt(xmlDOMWrapCtxt *ctxt)
+{
+    if (ctxt == NULL)
+	return;
+    if (ctxt->namespaceMap != NULL)
+	xmlDOMWrapNsMapFree((xmlNsMapPtr) ctxt->namespaceMap);
+    /*
+    * TODO: Store the namespace map in the context.
+    */
+    xmlFree(ctxt);
+}
+
+/**
+ * Searches for a ns-decl with the given prefix in `nsList`.
+ *
+ * @param nsList  a list of ns-structs
+ * @param prefix  the searched prefix
+ * @returns the ns-decl if found, NULL if not found and on
+ *          API errors.
+ */
+static xmlNsPtr
+xmlTreeNSListLookupByPrefix(xmlNsPtr nsList, const xmlChar *prefix)
+{
+    if (nsList == NULL)
+	return (NULL);
+    {
+	xmlNsPtr ns;
+	ns = nsList;
+	do {
+	    if ((prefix == ns->prefix) ||
+		xmlStrEqual(prefix, ns->prefix)) {
+		return (ns);
+	    }
+	    ns = ns->next;
+	} while (ns != NULL);
+    }
+    return (NULL);
+}
+
+/**
+ * Puts in-scope namespaces into the ns-map.
+ *
+ * @param map  the namespace map
+ * @param node  the node to start with
+ * @returns 0 on success, -1 on API or internal errors.
+ */
+static int
+xmlDOMWrapNSNormGatherInScopeNs(xmlNsMapPtr *map,
+				xmlNodePtr node)
+{
+    xmlNodePtr cur;
+    xmlNsPtr ns;
+    xmlNsMapItemPtr mi;
+    int shadowed;
+
+    if ((map == NULL) || (*map != NULL))
+	return (-1);
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
+        return (-1);
+    /*
+    * Get in-scope ns-decls of @parent.
+    */
+    cur = node;
+    while ((cur != NULL) && (cur != (xmlNodePtr) cur->doc)) {
+	if (cur->type == XML_ELEMENT_NODE) {
+	    if (cur->nsDef != NULL) {
+		ns = cur->nsDef;
+		do {
+		    shadowed = 0;
+		    if (XML_NSMAP_NOTEMPTY(*map)) {
+			/*
+			* Skip shadowed prefixes.
+			*/
+			XML_NSMAP_FOREACH(*map, mi) {
+			    if ((ns->prefix == mi->newNs->prefix) ||
+				xmlStrEqual(ns->prefix, mi->newNs->prefix)) {
+				shadowed = 1;
+				break;
+			    }
+			}
+		    }
+		    /*
+		    * Insert mapping.
+		    */
+		    mi = xmlDOMWrapNsMapAddItem(map, 0, NULL,
+			ns, XML_TREE_NSMAP_PARENT);
+		    if (mi == NULL)
+			return (-1);
+		    if (shadowed)
+			xmlDOMWrapNsMapShadow(*map, mi, 0);
+		    ns = ns->next;
+		} while (ns != NULL);
+	    }
+	}
+	cur = cur->parent;
+    }
+    return (0);
+}
+
+/*
+ * For internal use. Adds a ns-decl mapping.
+ *
+ * Returns 0 on success, -1 on internal errors.
+ */
+static int
+xmlDOMWrapNSNormAddNsMapItem2(xmlNsPtr **list, int *size, int *number,
+			xmlNsPtr oldNs, xmlNsPtr newNs)
+{
+    if (*number >= *size) {
+        xmlNsPtr *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(*size, 2 * sizeof(tmp[0]), 3, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(*list, newSize * 2 * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        *list = tmp;
+        *size = newSize;
+    }
+
+    (*list)[2 * (*number)] = oldNs;
+    (*list)[2 * (*number) +1] = newNs;
+    (*number)++;
+    return (0);
+}
+
+/**
+ * Unlinks the given node from its owner.
+ *
+ * This will substitute ns-references to node->nsDef for
+ * ns-references to doc->oldNs, thus ensuring the removed
+ * branch to be autark wrt ns-references.
+ *
+ * NOTE: This function was not intensively tested.
+ *
+ * @param ctxt  a DOM wrapper context
+ * @param doc  the doc
+ * @param node  the node to be removed.
+ * @param options  set of options, unused at the moment
+ * @returns 0 on success, 1 if the node is not supported,
+ *          -1 on API and internal errors.
+ */
+int
+xmlDOMWrapRemoveNode(xmlDOMWrapCtxt *ctxt, xmlDoc *doc,
+		     xmlNode *node, int options ATTRIBUTE_UNUSED)
+{
+    xmlNsPtr *list = NULL;
+    int sizeList = 0, nbList = 0, ret = 0, i, j;
+    xmlNsPtr ns;
+
+    if ((node == NULL) || (doc == NULL) || (node->doc != doc))
+	return (-1);
+
+    /* TODO: 0 or -1 ? */
+    if (node->parent == NULL)
+	return (0);
+
+    switch (node->type) {
+	case XML_TEXT_NODE:
+	case XML_CDATA_SECTION_NODE:
+	case XML_ENTITY_REF_NODE:
+	case XML_PI_NODE:
+	case XML_COMMENT_NODE:
+	    xmlUnlinkNodeInternal(node);
+	    return (0);
+	case XML_ELEMENT_NODE:
+	case XML_ATTRIBUTE_NODE:
+	    break;
+	default:
+	    return (1);
+    }
+    xmlUnlinkNodeInternal(node);
+    /*
+    * Save out-of-scope ns-references in doc->oldNs.
+    */
+    do {
+	switch (node->type) {
+	    case XML_ELEMENT_NODE:
+		if ((ctxt == NULL) && (node->nsDef != NULL)) {
+		    ns = node->nsDef;
+		    do {
+			if (xmlDOMWrapNSNormAddNsMapItem2(&list, &sizeList,
+			    &nbList, ns, ns) == -1)
+			    ret = -1;
+			ns = ns->next;
+		    } while (ns != NULL);
+		}
+                /* Falls through. */
+	    case XML_ATTRIBUTE_NODE:
+		if (node->ns != NULL) {
+		    /*
+		    * Find a mapping.
+		    */
+		    if (list != NULL) {
+			for (i = 0, j = 0; i < nbList; i++, j += 2) {
+			    if (node->ns == list[j]) {
+                                xmlNodeSourceChanged(node);
+				node->ns = list[++j];
+				goto next_node;
+			    }
+			}
+		    }
+		    ns = NULL;
+		    if (ctxt != NULL) {
+			/*
+			* User defined.
+			*/
+		    } else {
+			/*
+			* Add to doc's oldNs.
+			*/
+			ns = xmlDOMWrapStoreNs(doc, node->ns->href,
+			    node->ns->prefix);
+			if (ns == NULL)
+			    ret = -1;
+		    }
+		    if (ns != NULL) {
+			/*
+			* Add mapping.
+			*/
+			if (xmlDOMWrapNSNormAddNsMapItem2(&list, &sizeList,
+			    &nbList, node->ns, ns) == -1)
+			    ret = -1;
+		    }
+                    xmlNodeSourceChanged(node);
+		    node->ns = ns;
+		}
+		if ((node->type == XML_ELEMENT_NODE) &&
+		    (node->properties != NULL)) {
+		    node = (xmlNodePtr) node->properties;
+		    continue;
+		}
+		break;
+	    default:
+		goto next_sibling;
+	}
+next_node:
+	if ((node->type == XML_ELEMENT_NODE) &&
+	    (node->children != NULL)) {
+	    node = node->children;
+	    continue;
+	}
+next_sibling:
+	if (node == NULL)
+	    break;
+	if (node->next != NULL)
+	    node = node->next;
+	else {
+            int type = node->type;
+
+	    node = node->parent;
+            if ((type == XML_ATTRIBUTE_NODE) &&
+                (node != NULL) &&
+                (node->children != NULL)) {
+                node = node->children;
+            } else {
+	        goto next_sibling;
+            }
+	}
+    } while (node != NULL);
+
+    if (list != NULL)
+	xmlFree(list);
+    return (ret);
+}
+
+/**
+ * Dynamically searches for a ns-declaration which matches
+ * the given `nsName` in the ancestor-or-self axis of `node`.
+ *
+ * @param doc  the document
+ * @param node  the start node
+ * @param nsName  the searched namespace name
+ * @param retNs  the resulting ns-decl
+ * @param prefixed  if the found ns-decl must have a prefix
+ *                  (for attributes)
+ * @returns 1 if a ns-decl was found, 0 if not and -1 on API
+ *          and internal errors.
+ */
+static int
+xmlSearchNsByNamespaceStrict(xmlDocPtr doc, xmlNodePtr node,
+			     const xmlChar* nsName,
+			     xmlNsPtr *retNs, int prefixed)
+{
+    xmlNodePtr cur, prev = NULL, out = NULL;
+    xmlNsPtr ns, prevns;
+
+    if ((doc == NULL) || (nsName == NULL) || (retNs == NULL))
+	return (-1);
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL))
+        return(-1);
+
+    *retNs = NULL;
+    if (xmlStrEqual(nsName, XML_XML_NAMESPACE)) {
+	*retNs = xmlTreeEnsureXMLDecl(doc);
+	if (*retNs == NULL)
+	    return (-1);
+	return (1);
+    }
+    cur = node;
+    do {
+	if (cur->type == XML_ELEMENT_NODE) {
+	    if (cur->nsDef != NULL) {
+		for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+		    if (prefixed && (ns->prefix == NULL))
+			continue;
+		    if (prev != NULL) {
+			/*
+			* Check the last level of ns-decls for a
+			* shadowing prefix.
+			*/
+			prevns = prev->nsDef;
+			do {
+			    if ((prevns->prefix == ns->prefix) ||
+				((prevns->prefix != NULL) &&
+				(ns->prefix != NULL) &&
+				xmlStrEqual(prevns->prefix, ns->prefix))) {
+				/*
+				* Shadowed.
+				*/
+				break;
+			    }
+			    prevns = prevns->next;
+			} while (prevns != NULL);
+			if (prevns != NULL)
+			    continue;
+		    }
+		    /*
+		    * Ns-name comparison.
+		    */
+		    if ((nsName == ns->href) ||
+			xmlStrEqual(nsName, ns->href)) {
+			/*
+			* At this point the prefix can only be shadowed,
+			* if we are the the (at least) 3rd level of
+			* ns-decls.
+			*/
+			if (out) {
+			    int ret;
+
+			    ret = xmlNsInScope(doc, node, prev, ns->prefix);
+			    if (ret < 0)
+				return (-1);
+			    /*
+			    * TODO: Should we try to find a matching ns-name
+			    * only once? This here keeps on searching.
+			    * I think we should try further since, there might
+			    * be an other matching ns-decl with an unshadowed
+			    * prefix.
+			    */
+			    if (! ret)
+				continue;
+			}
+			*retNs = ns;
+			return (1);
+		    }
+		}
+		out = prev;
+		prev = cur;
+	    }
+	} else if (cur->type == XML_ENTITY_DECL)
+	    return (0);
+	cur = cur->parent;
+    } while ((cur != NULL) && (cur->doc != (xmlDocPtr) cur));
+    return (0);
+}
+
+/**
+ * Dynamically searches for a ns-declaration which matches
+ * the given `nsName` in the ancestor-or-self axis of `node`.
+ *
+ * @param doc  the document
+ * @param node  the start node
+ * @param prefix  the searched namespace prefix
+ * @param retNs  the resulting ns-decl
+ * @returns 1 if a ns-decl was found, 0 if not and -1 on API
+ *          and internal errors.
+ */
+static int
+xmlSearchNsByPrefixStrict(xmlDocPtr doc, xmlNodePtr node,
+			  const xmlChar* prefix,
+			  xmlNsPtr *retNs)
+{
+    xmlNodePtr cur;
+    xmlNsPtr ns;
+
+    if ((doc == NULL) || (node == NULL) || (node->type == XML_NAMESPACE_DECL))
+        return(-1);
+
+    if (retNs)
+	*retNs = NULL;
+    if (IS_STR_XML(prefix)) {
+	if (retNs) {
+	    *retNs = xmlTreeEnsureXMLDecl(doc);
+	    if (*retNs == NULL)
+		return (-1);
+	}
+	return (1);
+    }
+    cur = node;
+    do {
+	if (cur->type == XML_ELEMENT_NODE) {
+	    if (cur->nsDef != NULL) {
+		ns = cur->nsDef;
+		do {
+		    if ((prefix == ns->prefix) ||
+			xmlStrEqual(prefix, ns->prefix))
+		    {
+			/*
+			* Disabled namespaces, e.g. xmlns:abc="".
+			*/
+			if (ns->href == NULL)
+			    return(0);
+			if (retNs)
+			    *retNs = ns;
+			return (1);
+		    }
+		    ns = ns->next;
+		} while (ns != NULL);
+	    }
+	} else if (cur->type == XML_ENTITY_DECL)
+	    return (0);
+	cur = cur->parent;
+    } while ((cur != NULL) && (cur->doc != (xmlDocPtr) cur));
+    return (0);
+}
+
+/**
+ * Declares a new namespace on `elem`. It tries to use the
+ * given `prefix`. If a ns-decl with the given prefix is already existent
+ * on `elem`, it will generate an other prefix.
+ *
+ * @param doc  the doc
+ * @param elem  the element-node to declare on
+ * @param nsName  the namespace-name of the ns-decl
+ * @param prefix  the preferred prefix of the ns-decl
+ * @param checkShadow  ensure that the new ns-decl doesn't shadow
+ *                     ancestor ns-decls
+ * @returns 1 if a ns-decl was found, 0 if not and -1 on API
+ *          and internal errors.
+ */
+static xmlNsPtr
+xmlDOMWrapNSNormDeclareNsForced(xmlDocPtr doc,
+				xmlNodePtr elem,
+				const xmlChar *nsName,
+				const xmlChar *prefix,
+				int checkShadow)
+{
+
+    xmlNsPtr ret;
+    char buf[50];
+    const xmlChar *pref;
+    int counter = 0;
+
+    if ((doc == NULL) || (elem == NULL) || (elem->type != XML_ELEMENT_NODE))
+        return(NULL);
+    /*
+    * Create a ns-decl on @anchor.
+    */
+    pref = prefix;
+    while (1) {
+	/*
+	* Lookup whether the prefix is unused in elem's ns-decls.
+	*/
+	if ((elem->nsDef != NULL) &&
+	    (xmlTreeNSListLookupByPrefix(elem->nsDef, pref) != NULL))
+	    goto ns_next_prefix;
+	if (checkShadow && elem->parent &&
+	    ((xmlNodePtr) elem->parent->doc != elem->parent)) {
+	    /*
+	    * Does it shadow ancestor ns-decls?
+	    */
+	    if (xmlSearchNsByPrefixStrict(doc, elem->parent, pref, NULL) == 1)
+		goto ns_next_prefix;
+	}
+	ret = xmlNewNs(NULL, nsName, pref);
+	if (ret == NULL)
+	    return (NULL);
+        xmlDictNsId(doc->dict, nsName, 1);
+	if (elem->nsDef == NULL)
+	    elem->nsDef = ret;
+	else {
+	    xmlNsPtr ns2 = elem->nsDef;
+	    while (ns2->next != NULL)
+		ns2 = ns2->next;
+	    ns2->next = ret;
+	}
+	return (ret);
+ns_next_prefix:
+	counter++;
+	if (counter > 1000)
+	    return (NULL);
+	if (prefix == NULL) {
+	    snprintf((char *) buf, sizeof(buf),
+		"ns_%d", counter);
+	} else
+	    snprintf((char *) buf, sizeof(buf),
+	    "%.30s_%d", (char *)prefix, counter);
+	pref = BAD_CAST buf;
+    }
+}
+
+/**
+ * Searches for a matching ns-name in the ns-decls of `nsMap`, if not
+ * found it will either declare it on `elem`, or store it in `doc->oldNs`.
+ * If a new ns-decl needs to be declared on `elem`, it tries to use the
+ * `ns->prefix` for it, if this prefix is already in use on `elem`, it will
+ * change the prefix or the new ns-decl.
+ *
+ * @param doc  the doc
+ * @param elem  the element-node to declare namespaces on
+ * @param ns  the ns-struct to use for the search
+ * @param retNs  the found/created ns-struct
+ * @param nsMap  the ns-map
+ * @param depth  the current tree depth
+ * @param ancestorsOnly  search in ancestor ns-decls only
+ * @param prefixed  if the searched ns-decl must have a prefix
+ *                  (for attributes)
+ * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ */
+static int
+xmlDOMWrapNSNormAcquireNormalizedNs(xmlDocPtr doc,
+				   xmlNodePtr elem,
+				   xmlNsPtr ns,
+				   xmlNsPtr *retNs,
+				   xmlNsMapPtr *nsMap,
+
+				   int depth,
+				   int ancestorsOnly,
+				   int prefixed)
+{
+    xmlNsMapItemPtr mi;
+
+    if ((doc == NULL) || (ns == NULL) || (retNs == NULL) ||
+	(nsMap == NULL))
+	return (-1);
+
+    *retNs = NULL;
+    /*
+    * Handle XML namespace.
+    */
+    if (IS_STR_XML(ns->prefix)) {
+	/*
+	* Insert XML namespace mapping.
+	*/
+	*retNs = xmlTreeEnsureXMLDecl(doc);
+	if (*retNs == NULL)
+	    return (-1);
+	return (0);
+    }
+    /*
+    * If the search should be done in ancestors only and no
+    * @elem (the first ancestor) was specified, then skip the search.
+    */
+    if ((XML_NSMAP_NOTEMPTY(*nsMap)) &&
+	(! (ancestorsOnly && (elem == NULL))))
+    {
+	/*
+	* Try to find an equal ns-name in in-scope ns-decls.
+	*/
+	XML_NSMAP_FOREACH(*nsMap, mi) {
+	    if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
+		/*
+		* ancestorsOnly: This should be turned on to gain speed,
+		* if one knows that the branch itself was already
+		* ns-wellformed and no stale references existed.
+		* I.e. it searches in the ancestor axis only.
+		*/
+		((! ancestorsOnly) || (mi->depth == XML_TREE_NSMAP_PARENT)) &&
+		/* Skip shadowed prefixes. */
+		(mi->shadowDepth == -1) &&
+		/* Skip xmlns="" or xmlns:foo="". */
+		((mi->newNs->href != NULL) &&
+		(mi->newNs->href[0] != 0)) &&
+		/* Ensure a prefix if wanted. */
+		((! prefixed) || (mi->newNs->prefix != NULL)) &&
+		/* Equal ns name */
+		((mi->newNs->href == ns->href) ||
+		xmlStrEqual(mi->newNs->href, ns->href))) {
+		/* Set the mapping. */
+		mi->oldNs = ns;
+		(*nsMap)->gen++;
+		*retNs = mi->newNs;
+		return (0);
+	    }
+	}
+    }
+    /*
+    * No luck, the namespace is out of scope or shadowed.
+    */
+    if (elem == NULL) {
+	xmlNsPtr tmpns;
+
+	/*
+	* Store ns-decls in "oldNs" of the document-node.
+	*/
+	tmpns = xmlDOMWrapStoreNs(doc, ns->href, ns->prefix);
+	if (tmpns == NULL)
+	    return (-1);
+	/*
+	* Insert mapping.
+	*/
+	if (xmlDOMWrapNsMapAddItem(nsMap, -1, ns,
+		tmpns, XML_TREE_NSMAP_DOC) == NULL) {
+	    return (-1);
+	}
+	*retNs = tmpns;
+    } else {
+	xmlNsPtr tmpns;
+
+	tmpns = xmlDOMWrapNSNormDeclareNsForced(doc, elem, ns->href,
+	    ns->prefix, 0);
+	if (tmpns == NULL)
+	    return (-1);
+
+	if (*nsMap != NULL) {
+	    /*
+	    * Does it shadow ancestor ns-decls?
+	    */
+	    XML_NSMAP_FOREACH(*nsMap, mi) {
+		if ((mi->depth < depth) &&
+		    (mi->shadowDepth == -1) &&
+		    ((ns->prefix == mi->newNs->prefix) ||
+		    xmlStrEqual(ns->prefix, mi->newNs->prefix))) {
+		    /*
+		    * Shadows.
+		    */
+		    xmlDOMWrapNsMapShadow(*nsMap, mi, depth);
+		    break;
+		}
+	    }
+	}
+	if (xmlDOMWrapNsMapAddItem(nsMap, -1, ns, tmpns, depth) == NULL) {
+	    return (-1);
+	}
+	*retNs = tmpns;
+    }
+    return (0);
+}
+
+typedef enum {
+    XML_DOM_RECONNS_REMOVEREDUND = 1<<0
+} xmlDOMReconcileNSOptions;
+
+/**
+ * Fix up namespaces.
+ *
+ * Ensures that ns-references point to ns-decls hold on element-nodes.
+ * Ensures that the tree is namespace wellformed by creating additional
+ * ns-decls where needed. Note that, since prefixes of already existent
+ * ns-decls can be shadowed by this process, it could break QNames in
+ * attribute values or element content.
+ *
+ * NOTE: This function was not intensively tested.
+ *
+ * @param ctxt  DOM wrapper context, unused at the moment
+ * @param elem  the element-node
+ * @param options  option flags
+ * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ */
+int
+xmlDOMWrapReconcileNamespaces(xmlDOMWrapCtxt *ctxt ATTRIBUTE_UNUSED,
+			      xmlNode *elem,
+			      int options)
+{
+    int depth = -1, adoptns = 0, parnsdone = 0;
+    xmlNsPtr ns, prevns;
+    xmlDocPtr doc;
+    xmlNodePtr cur, curElem = NULL;
+    xmlNsMapPtr nsMap = NULL;
+    xmlNsMapItemPtr /* topmi = NULL, */ mi;
+    /* @ancestorsOnly should be set by an option flag. */
+    int ancestorsOnly = 0;
+    int optRemoveRedundantNS =
+	((xmlDOMReconcileNSOptions) options & XML_DOM_RECONNS_REMOVEREDUND) ? 1 : 0;
+    xmlNsPtr *listRedund = NULL;
+    int sizeRedund = 0, nbRedund = 0, ret = 0, i, j;
+
+    if ((elem == NULL) || (elem->doc == NULL) ||
+	(elem->type != XML_ELEMENT_NODE))
+	return (-1);
+
+    doc = elem->doc;
+    cur = elem;
+    do {
+	switch (cur->type) {
+	    case XML_ELEMENT_NODE:
+		adoptns = 1;
+		curElem = cur;
+		depth++;
+		/*
+		* Namespace declarations.
+		*/
+		if (cur->nsDef != NULL) {
+		    prevns = NULL;
+		    ns = cur->nsDef;
+		    while (ns != NULL) {
+			if (! parnsdone) {
+			    if ((elem->parent) &&
+				((xmlNodePtr) elem->parent->doc != elem->parent)) {
+				/*
+				* Gather ancestor in-scope ns-decls.
+				*/
+				if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
+				    elem->parent) == -1)
+				    ret = -1;
+			    }
+			    parnsdone = 1;
+			}
+
+			/*
+			* Lookup the ns ancestor-axis for equal ns-decls in scope.
+			*/
+			if (optRemoveRedundantNS && XML_NSMAP_NOTEMPTY(nsMap)) {
+			    XML_NSMAP_FOREACH(nsMap, mi) {
+				if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
+				    (mi->shadowDepth == -1) &&
+				    ((ns->prefix == mi->newNs->prefix) ||
+				      xmlStrEqual(ns->prefix, mi->newNs->prefix)) &&
+				    ((ns->href == mi->newNs->href) ||
+				      xmlStrEqual(ns->href, mi->newNs->href)))
+				{
+				    /*
+				    * A redundant ns-decl was found.
+				    * Add it to the list of redundant ns-decls.
+				    */
+				    if (xmlDOMWrapNSNormAddNsMapItem2(&listRedund,
+					&sizeRedund, &nbRedund, ns, mi->newNs) == -1) {
+					ret = -1;
+                                    } else {
+                                        /*
+                                        * Remove the ns-decl from the element-node.
+                                        */
+                                        xmlNodeSourceChanged(cur);
+                                        if (prevns)
+                                            prevns->next = ns->next;
+                                        else
+                                            cur->nsDef = ns->next;
+                                        goto next_ns_decl;
+                                    }
+				}
+			    }
+			}
+
+			/*
+			* Skip ns-references handling if the referenced
+			* ns-decl is declared on the same element.
+			*/
+			if ((cur->ns != NULL) && adoptns && (cur->ns == ns))
+			    adoptns = 0;
+			/*
+			* Does it shadow any ns-decl?
+			*/
+			if (XML_NSMAP_NOTEMPTY(nsMap)) {
+			    XML_NSMAP_FOREACH(nsMap, mi) {
+				if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
+				    (mi->shadowDepth == -1) &&
+				    ((ns->prefix == mi->newNs->prefix) ||
+				    xmlStrEqual(ns->prefix, mi->newNs->prefix))) {
+
+				    xmlDOMWrapNsMapShadow(nsMap, mi, depth);
+				}
+			    }
+			}
+			/*
+			* Push mapping.
+			*/
+			if (xmlDOMWrapNsMapAddItem(&nsMap, -1, ns, ns,
+			    depth) == NULL)
+			    ret = -1;
+
+			prevns = ns;
+next_ns_decl:
+			ns = ns->next;
+		    }
+		}
+		if (! adoptns)
+		    goto ns_end;
+                /* Falls through. */
+	    case XML_ATTRIBUTE_NODE:
+		/* No ns, no fun. */
+		if (cur->ns == NULL)
+		    goto ns_end;
+
+		if (! parnsdone) {
+		    if ((elem->parent) &&
+			((xmlNodePtr) elem->parent->doc != elem->parent)) {
+			if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
+				elem->parent) == -1)
+			    ret = -1;
+		    }
+		    parnsdone = 1;
+		}
+		/*
+		* Adjust the reference if this was a redundant ns-decl.
+		*/
+		if (listRedund) {
+		   for (i = 0, j = 0; i < nbRedund; i++, j += 2) {
+		       if (cur->ns == listRedund[j]) {
+                           xmlNodeSourceChanged(cur);
+			   cur->ns = listRedund[++j];
+			   break;
+		       }
+		   }
+		}
+		/*
+		* Adopt ns-references.
+		*/
+		if (XML_NSMAP_NOTEMPTY(nsMap)) {
+		    /*
+		    * Search for a mapping.
+		    */
+		    mi = xmlDOMWrapNsMapLookup(nsMap, cur->ns);
+		    if (mi != NULL) {
+                        xmlNodeSourceChanged(cur);
+			cur->ns = mi->newNs;
+			goto ns_end;
+		    }
+		}
+		/*
+		* Acquire a normalized ns-decl and add it to the map.
+		*/
+		if (xmlDOMWrapNSNormAcquireNormalizedNs(doc, curElem,
+			cur->ns, &ns,
+			&nsMap, depth,
+			ancestorsOnly,
+			(cur->type == XML_ATTRIBUTE_NODE) ? 1 : 0) == -1)
+		    ret = -1;
+                xmlNodeSourceChanged(cur);
+		cur->ns = ns;
+
+ns_end:
+		if ((cur->type == XML_ELEMENT_NODE) &&
+		    (cur->properties != NULL)) {
+		    /*
+		    * Process attributes.
+		    */
+		    cur = (xmlNodePtr) cur->properties;
+		    continue;
+		}
+		break;
+	    default:
+		goto next_sibling;
+	}
+into_content:
+	if ((cur->type == XML_ELEMENT_NODE) &&
+	    (cur->children != NULL)) {
+	    /*
+	    * Process content of element-nodes only.
+	    */
+	    cur = cur->children;
+	    continue;
+	}
+next_sibling:
+	if (cur == elem)
+	    break;
+	if (cur->type == XML_ELEMENT_NODE) {
+	    if (XML_NSMAP_NOTEMPTY(nsMap))
+		xmlDOMWrapNsMapPop(nsMap, depth);
+	    depth--;
+	}
+	if (cur->next != NULL)
+	    cur = cur->next;
+	else {
+	    if (cur->type == XML_ATTRIBUTE_NODE) {
+		cur = cur->parent;
+		goto into_content;
+	    }
+	    cur = cur->parent;
+	    goto next_sibling;
+	}
+    } while (cur != NULL);
+
+    if (listRedund) {
+	for (i = 0, j = 0; i < nbRedund; i++, j += 2) {
+	    xmlFreeNs(listRedund[j]);
+	}
+	xmlFree(listRedund);
+    }
+    if (nsMap != NULL)
+	xmlDOMWrapNsMapFree(nsMap);
+    return (ret);
+}
+
+/**
+ * Ensures that ns-references point to `destDoc`: either to
+ * `elements->nsDef` entries if `destParent` is given, or to
+ * `destDoc->oldNs` otherwise.
+ *
+ * If `destParent` is given, it ensures that the tree is namespace
+ * wellformed by creating additional ns-decls where needed.
+ * Note that, since prefixes of already existent ns-decls can be
+ * shadowed by this process, it could break QNames in attribute
+ * values or element content.
+ *
+ * NOTE: This function was not intensively tested.
+ *
+ * @param ctxt  the optional context for custom processing
+ * @param sourceDoc  the optional sourceDoc
+ * @param node  the element-node to start with
+ * @param destDoc  the destination doc for adoption
+ * @param destParent  the optional new parent of `node` in `destDoc`
+ * @param options  option flags
+ * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ */
+static int
+xmlDOMWrapAdoptBranch(xmlDOMWrapCtxtPtr ctxt,
+		      xmlDocPtr sourceDoc ATTRIBUTE_UNUSED,
+		      xmlNodePtr node,
+		      xmlDocPtr destDoc,
+		      xmlNodePtr destParent,
+		      int options ATTRIBUTE_UNUSED)
+{
+    int ret = 0;
+    xmlNodePtr cur, curElem = NULL;
+    xmlNsMapPtr nsMap = NULL;
+    xmlNsMapItemPtr mi;
+    xmlNsPtr ns = NULL;
+    int depth = -1;
+    /* gather @parent's ns-decls. */
+    int parnsdone;
+    /* @ancestorsOnly should be set per option. */
+    int ancestorsOnly = 0;
+
+    /*
+    * Get the ns-map from the context if available.
+    */
+    if (ctxt)
+	nsMap = (xmlNsMapPtr) ctxt->namespaceMap;
+    /*
+    * Disable search for ns-decls in the parent-axis of the
+    * destination element, if:
+    * 1) there's no destination parent
+    * 2) custom ns-reference handling is used
+    */
+    if ((destParent == NULL) ||
+	(ctxt && ctxt->getNsForNodeFunc))
+    {
+	parnsdone = 1;
+    } else
+	parnsdone = 0;
+
+    cur = node;
+
+    while (cur != NULL) {
+        if (cur->doc != destDoc) {
+            if (xmlNodeSetDoc(cur, destDoc) < 0)
+                ret = -1;
+        }
+
+	switch (cur->type) {
+	    case XML_XINCLUDE_START:
+	    case XML_XINCLUDE_END:
+		/*
+		* TODO
+		*/
+		ret = -1;
+                goto leave_node;
+	    case XML_ELEMENT_NODE:
+		curElem = cur;
+		depth++;
+		/*
+		* Namespace declarations.
+		* - ns->href and ns->prefix are never in the dict, so
+		*   we need not move the values over to the destination dict.
+		* - Note that for custom handling of ns-references,
+		*   the ns-decls need not be stored in the ns-map,
+		*   since they won't be referenced by node->ns.
+		*/
+		if ((cur->nsDef) &&
+		    ((ctxt == NULL) || (ctxt->getNsForNodeFunc == NULL)))
+		{
+		    if (! parnsdone) {
+			/*
+			* Gather @parent's in-scope ns-decls.
+			*/
+			if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
+			    destParent) == -1)
+			    ret = -1;
+			parnsdone = 1;
+		    }
+		    for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+			/*
+			* NOTE: ns->prefix and ns->href are never in the dict.
+			*/
+			/*
+			* Does it shadow any ns-decl?
+			*/
+			if (XML_NSMAP_NOTEMPTY(nsMap)) {
+			    XML_NSMAP_FOREACH(nsMap, mi) {
+				if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
+				    (mi->shadowDepth == -1) &&
+				    ((ns->prefix == mi->newNs->prefix) ||
+				    xmlStrEqual(ns->prefix,
+				    mi->newNs->prefix))) {
+
+				    xmlDOMWrapNsMapShadow(nsMap, mi, depth);
+				}
+			    }
+			}
+			/*
+			* Push mapping.
+			*/
+			if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
+			    ns, ns, depth) == NULL)
+			    ret = -1;
+		    }
+		}
+                /* Falls through. */
+	    case XML_ATTRIBUTE_NODE:
+		/* No namespace, no fun. */
+		if (cur->ns == NULL)
+		    goto ns_end;
+
+		if (! parnsdone) {
+		    if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
+			destParent) == -1)
+			ret = -1;
+		    parnsdone = 1;
+		}
+		/*
+		* Adopt ns-references.
+		*/
+		if (XML_NSMAP_NOTEMPTY(nsMap)) {
+		    /*
+		    * Search for a mapping.
+		    */
+		    mi = xmlDOMWrapNsMapLookup(nsMap, cur->ns);
+		    if (mi != NULL) {
+                        xmlNodeSourceChanged(cur);
+			cur->ns = mi->newNs;
+			goto ns_end;
+		    }
+		}
+		/*
+		* No matching namespace in scope. We need a new one.
+		*/
+		if ((ctxt) && (ctxt->getNsForNodeFunc)) {
+		    /*
+		    * User-defined behaviour.
+		    */
+		    ns = ctxt->getNsForNodeFunc(ctxt, cur,
+			cur->ns->href, cur->ns->prefix);
+		    /*
+		    * Insert mapping if ns is available; it's the users fault
+		    * if not.
+		    */
+		    if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
+			    cur->ns, ns, XML_TREE_NSMAP_CUSTOM) == NULL)
+			ret = -1;
+		    cur->ns = ns;
+		} else {
+		    /*
+		    * Acquire a normalized ns-decl and add it to the map.
+		    */
+		    if (xmlDOMWrapNSNormAcquireNormalizedNs(destDoc,
+			/* ns-decls on curElem or on destDoc->oldNs */
+			destParent ? curElem : NULL,
+			cur->ns, &ns,
+			&nsMap, depth,
+			ancestorsOnly,
+			/* ns-decls must be prefixed for attributes. */
+			(cur->type == XML_ATTRIBUTE_NODE) ? 1 : 0) == -1)
+			ret = -1;
+		    cur->ns = ns;
+		}
+
+ns_end:
+		if (cur->type == XML_ELEMENT_NODE) {
+		    cur->psvi = NULL;
+		    cur->line = 0;
+		    cur->extra = 0;
+		    /*
+		    * Walk attributes.
+		    */
+		    if (cur->properties != NULL) {
+			/*
+			* Process first attribute node.
+			*/
+			cur = (xmlNodePtr) cur->properties;
+			continue;
+		    }
+		}
+		break;
+	    case XML_TEXT_NODE:
+	    case XML_CDATA_SECTION_NODE:
+	    case XML_PI_NODE:
+	    case XML_COMMENT_NODE:
+	    case XML_ENTITY_REF_NODE:
+		goto leave_node;
+	    default:
+		ret = -1;
+	}
+	/*
+	* Walk the tree.
+	*/
+	if (cur->children != NULL) {
+	    cur = cur->children;
+	    continue;
+	}
+
+leave_node:
+	if (cur == node)
+	    break;
+	if ((cur->type == XML_ELEMENT_NODE) ||
+	    (cur->type == XML_XINCLUDE_START) ||
+	    (cur->type == XML_XINCLUDE_END))
+	{
+	    /*
+	    * TODO: Do we expect nsDefs on XML_XINCLUDE_START?
+	    */
+	    if (XML_NSMAP_NOTEMPTY(nsMap))
+		xmlDOMWrapNsMapPop(nsMap, depth);
+	    depth--;
+	}
+	if (cur->next != NULL)
+	    cur = cur->next;
+	else if ((cur->type == XML_ATTRIBUTE_NODE) &&
+	    (cur->parent->children != NULL))
+	{
+	    cur = cur->parent->children;
+	} else {
+	    cur = cur->parent;
+	    goto leave_node;
+	}
+    }
+
+    /*
+    * Cleanup.
+    */
+    if (nsMap != NULL) {
+	if ((ctxt) && (ctxt->namespaceMap == nsMap)) {
+	    /*
+	    * Just cleanup the map but don't free.
+	    */
+	    if (nsMap->first) {
+		if (nsMap->pool)
+		    nsMap->last->next = nsMap->pool;
+		nsMap->pool = nsMap->first;
+		nsMap->first = NULL;
+	    }
+	} else
+	    xmlDOMWrapNsMapFree(nsMap);
+    }
+    return(ret);
+}
+
+/**
+ * Clone a node and fix namespaces.
+ *
+ * References of out-of scope ns-decls are remapped to point to `destDoc`.
+ * If `destParent` is given, then nsDef entries on element-nodes are used.
+ * If *no* `destParent` is given, then `destDoc->oldNs` entries are used.
+ * This is the case when you don't know already where the cloned branch
+ * will be added to.
+ *
+ * If `destParent` is given, it ensures that the tree is namespace
+ * wellformed by creating additional ns-decls where needed.
+ * Note that, since prefixes of already existent ns-decls can be
+ * shadowed by this process, it could break QNames in attribute
+ * values or element content.
+ *
+ * @param ctxt  the optional context for custom processing
+ * @param sourceDoc  the optional sourceDoc
+ * @param node  the node to start with
+ * @param resNode  the clone of the given `node`
+ * @param destDoc  the destination doc
+ * @param destParent  the optional new parent of `node` in `destDoc`
+ * @param deep  descend into child if set
+ * @param options  option flags
+ * @returns 0 if the operation succeeded,
+ *          1 if a node of unsupported (or not yet supported) type was given,
+ *          -1 on API/internal errors.
+ */
+int
+xmlDOMWrapCloneNode(xmlDOMWrapCtxt *ctxt,
+		      xmlDoc *sourceDoc,
+		      xmlNode *node,
+		      xmlNode **resNode,
+		      xmlDoc *destDoc,
+		      xmlNode *destParent,
+		      int deep,
+		      int options ATTRIBUTE_UNUSED)
+{
+    int ret = 0;
+    xmlNodePtr cur, cloneElem = NULL;
+    xmlNsMapPtr nsMap = NULL;
+    xmlNsMapItemPtr mi;
+    xmlNsPtr ns;
+    int depth = -1;
+    /* int adoptStr = 1; */
+    /* gather @parent's ns-decls. */
+    int parnsdone = 0;
+    /*
+    * @ancestorsOnly:
+    * TODO: @ancestorsOnly should be set per option.
+    *
+    */
+    int ancestorsOnly = 0;
+    xmlNodePtr resultClone = NULL, clone = NULL, parentClone = NULL, prevClone = NULL;
+    xmlNsPtr cloneNs = NULL, *cloneNsDefSlot = NULL;
+    xmlDictPtr dict; /* The destination dict */
+
+    if ((node == NULL) || (resNode == NULL) || (destDoc == NULL) ||
+	((destParent != NULL) && (destParent->doc != destDoc)))
+	return(-1);
+    /*
+    * TODO: Initially we support only element-nodes.
+    */
+    if (node->type != XML_ELEMENT_NODE)
+	return(1);
+    /*
+    * Check node->doc sanity.
+    */
+    if ((node->doc != NULL) && (sourceDoc != NULL) &&
+	(node->doc != sourceDoc)) {
+	/*
+	* Might be an XIncluded node.
+	*/
+	return (-1);
+    }
+    if (sourceDoc == NULL)
+	sourceDoc = node->doc;
+    if (sourceDoc == NULL)
+        return (-1);
+
+    dict = destDoc->dict;
+    /*
+    * Reuse the namespace map of the context.
+    */
+    if (ctxt)
+	nsMap = (xmlNsMapPtr) ctxt->namespaceMap;
+
+    *resNode = NULL;
+
+    cur = node;
+    while (cur != NULL) {
+	if (cur->doc != sourceDoc) {
+	    /*
+	    * We'll assume XIncluded nodes if the doc differs.
+	    * TODO: Do we need to reconciliate XIncluded nodes?
+	    * TODO: This here returns -1 in this case.
+	    */
+	    goto internal_error;
+	}
+	/*
+	* Create a new node.
+	*/
+	switch (cur->type) {
+	    case XML_XINCLUDE_START:
+	    case XML_XINCLUDE_END:
+		/*
+		* TODO: What to do with XInclude?
+		*/
+		goto internal_error;
+		break;
+	    case XML_ELEMENT_NODE:
+	    case XML_TEXT_NODE:
+	    case XML_CDATA_SECTION_NODE:
+	    case XML_COMMENT_NODE:
+	    case XML_PI_NODE:
+	    case XML_DOCUMENT_FRAG_NODE:
+	    case XML_ENTITY_REF_NODE:
+		/*
+		* Nodes of xmlNode structure.
+		*/
+		clone = (xmlNodePtr) xmlMalloc(sizeof(xmlNode));
+		if (clone == NULL)
+		    goto internal_error;
+		memset(clone, 0, sizeof(xmlNode));
+		/*
+		* Set hierarchical links.
+		*/
+		if (resultClone != NULL) {
+		    clone->parent = parentClone;
+		    if (prevClone) {
+			prevClone->next = clone;
+			clone->prev = prevClone;
+		    } else
+			parentClone->children = clone;
+                    parentClone->last = clone;
+		} else
+		    resultClone = clone;
+
+		break;
+	    case XML_ATTRIBUTE_NODE:
+		/*
+		* Attributes (xmlAttr).
+		*/
+		clone = xmlMalloc(sizeof(xmlAttr));
+		if (clone == NULL)
+		    goto internal_error;
+		memset(clone, 0, sizeof(xmlAttr));
+		/*
+		* Set hierarchical links.
+		* TODO: Change this to add to the end of attributes.
+		*/
+		if (resultClone != NULL) {
+		    clone->parent = parentClone;
+		    if (prevClone) {
+			prevClone->next = clone;
+			clone->prev = prevClone;
+		    } else
+			parentClone->properties = (xmlAttrPtr) clone;
+		} else
+		    resultClone = clone;
+		break;
+	    default:
+		/*
+		* TODO QUESTION: Any other nodes expected?
+		*/
+		goto internal_error;
+	}
+
+	clone->type = cur->type;
+	clone->doc = destDoc;
+
+	/*
+	* Clone the name of the node if any.
+	*/
+	if (cur->name == xmlStringText)
+	    clone->name = xmlStringText;
+	else if (cur->name == xmlStringTextNoenc)
+	    /*
+	    * NOTE: Although xmlStringTextNoenc is never assigned to a node
+	    *   in tree.c, it might be set in Libxslt via
+	    *   "xsl:disable-output-escaping".
+	    */
+	    clone->name = xmlStringTextNoenc;
+	else if (cur->name == xmlStringComment)
+	    clone->name = xmlStringComment;
+	else if (cur->name != NULL) {
+            if (dict != NULL)
+                clone->name = xmlDictLookup(dict, cur->name, -1);
+            else
+                clone->name = xmlStrdup(cur->name);
+            if (clone->name == NULL)
+                goto internal_error;
+	}
+
+	switch (cur->type) {
+	    case XML_XINCLUDE_START:
+	    case XML_XINCLUDE_END:
+		/*
+		* TODO
+		*/
+		return (-1);
+	    case XML_ELEMENT_NODE:
+		cloneElem = clone;
+		depth++;
+		/*
+		* Namespace declarations.
+		*/
+		if (cur->nsDef != NULL) {
+		    if (! parnsdone) {
+			if (destParent && (ctxt == NULL)) {
+			    /*
+			    * Gather @parent's in-scope ns-decls.
+			    */
+			    if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap,
+				destParent) == -1)
+				goto internal_error;
+			}
+			parnsdone = 1;
+		    }
+		    /*
+		    * Clone namespace declarations.
+		    */
+		    cloneNsDefSlot = &(clone->nsDef);
+		    for (ns = cur->nsDef; ns != NULL; ns = ns->next) {
+			/*
+			* Create a new xmlNs.
+			*/
+			cloneNs = (xmlNsPtr) xmlMalloc(sizeof(xmlNs));
+			if (cloneNs == NULL)
+			    goto internal_error;
+			memset(cloneNs, 0, sizeof(xmlNs));
+			cloneNs->type = XML_LOCAL_NAMESPACE;
+
+			if (ns->href != NULL) {
+			    cloneNs->href = xmlStrdup(ns->href);
+                            if (cloneNs->href == NULL) {
+                                xmlFreeNs(cloneNs);
+                                goto internal_error;
+                            }
+                            xmlDictNsId(destDoc->dict, ns->href, 1);
+                        }
+			if (ns->prefix != NULL) {
+			    cloneNs->prefix = xmlStrdup(ns->prefix);
+                            if (cloneNs->prefix == NULL) {
+                                xmlFreeNs(cloneNs);
+                                goto internal_error;
+                            }
+                        }
+
+			*cloneNsDefSlot = cloneNs;
+			cloneNsDefSlot = &(cloneNs->next);
+
+			/*
+			* Note that for custom handling of ns-references,
+			* the ns-decls need not be stored in the ns-map,
+			* since they won't be referenced by node->ns.
+			*/
+			if ((ctxt == NULL) ||
+			    (ctxt->getNsForNodeFunc == NULL))
+			{
+			    /*
+			    * Does it shadow any ns-decl?
+			    */
+			    if (XML_NSMAP_NOTEMPTY(nsMap)) {
+				XML_NSMAP_FOREACH(nsMap, mi) {
+				    if ((mi->depth >= XML_TREE_NSMAP_PARENT) &&
+					(mi->shadowDepth == -1) &&
+					((ns->prefix == mi->newNs->prefix) ||
+					xmlStrEqual(ns->prefix,
+					mi->newNs->prefix))) {
+					/*
+					* Mark as shadowed at the current
+					* depth.
+					*/
+					xmlDOMWrapNsMapShadow(nsMap, mi, depth);
+				    }
+				}
+			    }
+			    /*
+			    * Push mapping.
+			    */
+			    if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
+				ns, cloneNs, depth) == NULL)
+				goto internal_error;
+			}
+		    }
+		}
+		/* cur->ns will be processed further down. */
+		break;
+	    case XML_ATTRIBUTE_NODE:
+		/* IDs will be processed further down. */
+		/* cur->ns will be processed further down. */
+		break;
+	    case XML_PI_NODE:
+	    case XML_COMMENT_NODE:
+	    case XML_TEXT_NODE:
+	    case XML_CDATA_SECTION_NODE:
+		/*
+		* Note that this will also cover the values of attributes.
+		*/
+                if (cur->content != NULL) {
+                    clone->content = xmlStrdup(cur->content);
+                    if (clone->content == NULL)
+                        goto internal_error;
+                }
+		goto leave_node;
+	    case XML_ENTITY_REF_NODE:
+		if (sourceDoc != destDoc) {
+		    if ((destDoc->intSubset) || (destDoc->extSubset)) {
+			xmlEntityPtr ent;
+			/*
+			* Different doc: Assign new entity-node if available.
+			*/
+			ent = xmlGetDocEntity(destDoc, cur->name);
+			if (ent != NULL) {
+			    clone->content = ent->content;
+			    clone->children = (xmlNodePtr) ent;
+			    clone->last = (xmlNodePtr) ent;
+			}
+		    }
+		} else {
+		    /*
+		    * Same doc: Use the current node's entity declaration
+		    * and value.
+		    */
+		    clone->content = cur->content;
+		    clone->children = cur->children;
+		    clone->last = cur->last;
+		}
+		goto leave_node;
+	    default:
+		goto internal_error;
+	}
+
+	if (cur->ns == NULL)
+	    goto end_ns_reference;
+
+/* handle_ns_reference: */
+	/*
+	** The following will take care of references to ns-decls ********
+	** and is intended only for element- and attribute-nodes.
+	**
+	*/
+	if (! parnsdone) {
+	    if (destParent && (ctxt == NULL)) {
+		if (xmlDOMWrapNSNormGatherInScopeNs(&nsMap, destParent) == -1)
+		    goto internal_error;
+	    }
+	    parnsdone = 1;
+	}
+	/*
+	* Adopt ns-references.
+	*/
+	if (XML_NSMAP_NOTEMPTY(nsMap)) {
+	    /*
+	    * Search for a mapping.
+	    */
+	    mi = xmlDOMWrapNsMapLookup(nsMap, cur->ns);
+	    if (mi != NULL) {
+		/*
+		* This is the nice case: a mapping was found.
+		*/
+		clone->ns = mi->newNs;
+		goto end_ns_reference;
+	    }
+	}
+	/*
+	* No matching namespace in scope. We need a new one.
+	*/
+	if ((ctxt != NULL) && (ctxt->getNsForNodeFunc != NULL)) {
+	    /*
+	    * User-defined behaviour.
+	    */
+	    ns = ctxt->getNsForNodeFunc(ctxt, cur,
+		cur->ns->href, cur->ns->prefix);
+	    /*
+	    * Add user's mapping.
+	    */
+	    if (xmlDOMWrapNsMapAddItem(&nsMap, -1,
+		cur->ns, ns, XML_TREE_NSMAP_CUSTOM) == NULL)
+		goto internal_error;
+	    clone->ns = ns;
+	} else {
+	    /*
+	    * Acquire a normalized ns-decl and add it to the map.
+	    */
+	    if (xmlDOMWrapNSNormAcquireNormalizedNs(destDoc,
+		/* ns-decls on cloneElem or on destDoc->oldNs */
+		destParent ? cloneElem : NULL,
+		cur->ns, &ns,
+		&nsMap, depth,
+		/* if we need to search only in the ancestor-axis */
+		ancestorsOnly,
+		/* ns-decls must be prefixed for attributes. */
+		(cur->type == XML_ATTRIBUTE_NODE) ? 1 : 0) == -1)
+		goto internal_error;
+	    clone->ns = ns;
+	}
+
+end_ns_reference:
+
+	/*
+	* Some post-processing.
+	*
+	* Handle ID attributes.
+	*/
+	if ((clone->type == XML_ATTRIBUTE_NODE) &&
+	    (clone->parent != NULL))
+	{
+            int res;
+
+	    res = xmlIsID(destDoc, clone->parent, (xmlAttrPtr) clone);
+            if (res < 0)
+                goto internal_error;
+            if (res == 1) {
+		xmlChar *idVal;
+
+		idVal = xmlNodeGetContent(cur);
+                if (idVal == NULL)
+                    goto internal_error;
+                if (xmlAddIDSafe((xmlAttrPtr) cur, idVal) < 0) {
+                    xmlFree(idVal);
+                    goto internal_error;
+                }
+                xmlFree(idVal);
+	    }
+	}
+	/*
 	**
 	** The following will traverse the tree **************************
 	**
@@ -8569,249 +12822,1617 @@ into_content:
 	    }
 	}
 
-leave_node:
-	/*
-	* At this point we are done with the node, its content
-	* and an element-nodes's attribute-nodes.
-	*/
-	if (cur == node)
-	    break;
-	if ((cur->type == XML_ELEMENT_NODE) ||
-	    (cur->type == XML_XINCLUDE_START) ||
-	    (cur->type == XML_XINCLUDE_END)) {
-	    /*
-	    * TODO: Do we expect nsDefs on XML_XINCLUDE_START?
-	    */
-	    if (XML_NSMAP_NOTEMPTY(nsMap)) {
-		/*
-		* Pop mappings.
-		*/
-		while ((nsMap->last != NULL) &&
-		    (nsMap->last->depth >= depth))
-		{
-		    XML_NSMAP_POP(nsMap, mi)
-		}
-		/*
-		* Unshadow.
-		*/
-		XML_NSMAP_FOREACH(nsMap, mi) {
-		    if (mi->shadowDepth >= depth)
-			mi->shadowDepth = -1;
-		}
-	    }
-	    depth--;
-	}
-	if (cur->next != NULL) {
-	    prevClone = clone;
-	    cur = cur->next;
-	} else if (cur->type != XML_ATTRIBUTE_NODE) {
-	    clone = clone->parent;
-	    if (clone != NULL)
-		parentClone = clone->parent;
-	    /*
-	    * Process parent --> next;
-	    */
-	    cur = cur->parent;
-	    goto leave_node;
-	} else {
-	    /* This is for attributes only. */
-	    clone = clone->parent;
-	    parentClone = clone->parent;
-	    /*
-	    * Process parent-element --> children.
-	    */
-	    cur = cur->parent;
-	    goto into_content;
-	}
+leave_node:
+	/*
+	* At this point we are done with the node, its content
+	* and an element-nodes's attribute-nodes.
+	*/
+	if (cur == node)
+	    break;
+	if ((cur->type == XML_ELEMENT_NODE) ||
+	    (cur->type == XML_XINCLUDE_START) ||
+	    (cur->type == XML_XINCLUDE_END)) {
+	    /*
+	    * TODO: Do we expect nsDefs on XML_XINCLUDE_START?
+	    */
+	    if (XML_NSMAP_NOTEMPTY(nsMap))
+		xmlDOMWrapNsMapPop(nsMap, depth);
+	    depth--;
+	}
+	if (cur->next != NULL) {
+	    prevClone = clone;
+	    cur = cur->next;
+	} else if (cur->type != XML_ATTRIBUTE_NODE) {
+	    clone = clone->parent;
+	    if (clone != NULL)
+		parentClone = clone->parent;
+	    /*
+	    * Process parent --> next;
+	    */
+	    cur = cur->parent;
+	    goto leave_node;
+	} else {
+	    /* This is for attributes only. */
+	    clone = clone->parent;
+	    parentClone = clone->parent;
+	    /*
+	    * Process parent-element --> children.
+	    */
+	    cur = cur->parent;
+	    goto into_content;
+	}
+    }
+    goto exit;
+
+internal_error:
+    ret = -1;
+
+exit:
+    /*
+    * Cleanup.
+    */
+    if (nsMap != NULL) {
+	if ((ctxt) && (ctxt->namespaceMap == nsMap)) {
+	    /*
+	    * Just cleanup the map but don't free.
+	    */
+	    if (nsMap->first) {
+		if (nsMap->pool)
+		    nsMap->last->next = nsMap->pool;
+		nsMap->pool = nsMap->first;
+		nsMap->first = NULL;
+	    }
+	} else
+	    xmlDOMWrapNsMapFree(nsMap);
+    }
+    /*
+    * TODO: Should we try a cleanup of the cloned node in case of a
+    * fatal error?
+    */
+    *resNode = resultClone;
+    return (ret);
+}
+
+/**
+ * `attr` is adopted by `destDoc`.
+ * Ensures that ns-references point to `destDoc`: either to
+ * `elements->nsDef` entries if `destParent` is given, or to
+ * `destDoc->oldNs` otherwise.
+ *
+ * @param ctxt  the optional context for custom processing
+ * @param sourceDoc  unused
+ * @param attr  the attribute-node to be adopted
+ * @param destDoc  the destination doc for adoption
+ * @param destParent  the optional new parent of `attr` in `destDoc`
+ * @param options  option flags (unused)
+ * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ */
+static int
+xmlDOMWrapAdoptAttr(xmlDOMWrapCtxtPtr ctxt,
+		    xmlDocPtr sourceDoc ATTRIBUTE_UNUSED,
+		    xmlAttrPtr attr,
+		    xmlDocPtr destDoc,
+		    xmlNodePtr destParent,
+		    int options ATTRIBUTE_UNUSED)
+{
+    int ret = 0;
+
+    if ((attr == NULL) || (destDoc == NULL))
+	return (-1);
+
+    if (attr->doc != destDoc) {
+        if (xmlSetTreeDoc((xmlNodePtr) attr, destDoc) < 0)
+            ret = -1;
+    }
+
+    if (attr->ns != NULL) {
+	xmlNsPtr ns = NULL;
+
+	if (ctxt != NULL) {
+	    /* TODO: User defined. */
+	}
+	/* XML Namespace. */
+	if (IS_STR_XML(attr->ns->prefix)) {
+	    ns = xmlTreeEnsureXMLDecl(destDoc);
+	} else if (destParent == NULL) {
+	    /*
+	    * Store in @destDoc->oldNs.
+	    */
+	    ns = xmlDOMWrapStoreNs(destDoc, attr->ns->href, attr->ns->prefix);
+	} else {
+	    /*
+	    * Declare on @destParent.
+	    */
+	    if (xmlSearchNsByNamespaceStrict(destDoc, destParent, attr->ns->href,
+		&ns, 1) == -1)
+		ret = -1;
+	    if (ns == NULL) {
+		ns = xmlDOMWrapNSNormDeclareNsForced(destDoc, destParent,
+		    attr->ns->href, attr->ns->prefix, 1);
+	    }
+	}
+	if (ns == NULL)
+	    ret = -1;
+	attr->ns = ns;
+    }
+
+    return (ret);
+}
+
+/**
+ * Fix up namespaces before moving a node.
+ *
+ * References of out-of scope ns-decls are remapped to point to `destDoc`:
+ * If `destParent` is given, then nsDef entries on element-nodes are used.
+ * If *no* `destParent` is given, then `destDoc->oldNs` entries are used
+ * This is the case when you have an unlinked node and just want to move it
+ * to the context of.
+ *
+ * If `destParent` is given, it ensures that the tree is namespace
+ * wellformed by creating additional ns-decls where needed.
+ * Note that, since prefixes of already existent ns-decls can be
+ * shadowed by this process, it could break QNames in attribute
+ * values or element content.
+ *
+ * NOTE: This function was not intensively tested.
+ *
+ * @param ctxt  the optional context for custom processing
+ * @param sourceDoc  the optional sourceDoc
+ * @param node  the node to start with
+ * @param destDoc  the destination doc
+ * @param destParent  the optional new parent of `node` in `destDoc`
+ * @param options  option flags
+ * @returns 0 if the operation succeeded,
+ *          1 if a node of unsupported type was given,
+ *          2 if a node of not yet supported type was given and
+ *          -1 on API/internal errors.
+ */
+int
+xmlDOMWrapAdoptNode(xmlDOMWrapCtxt *ctxt,
+		    xmlDoc *sourceDoc,
+		    xmlNode *node,
+		    xmlDoc *destDoc,
+		    xmlNode *destParent,
+		    int options)
+{
+    int ret = 0;
+
+    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL) ||
+        (destDoc == NULL) ||
+	((destParent != NULL) && (destParent->doc != destDoc)))
+	return(-1);
+    /*
+    * Check node->doc sanity.
+    */
+    if (sourceDoc == NULL) {
+        sourceDoc = node->doc;
+    } else if (node->doc != sourceDoc) {
+	return (-1);
+    }
+
+    /*
+     * TODO: Shouldn't this be allowed?
+     */
+    if (sourceDoc == destDoc)
+	return (-1);
+
+    switch (node->type) {
+	case XML_ELEMENT_NODE:
+	case XML_ATTRIBUTE_NODE:
+	case XML_TEXT_NODE:
+	case XML_CDATA_SECTION_NODE:
+	case XML_ENTITY_REF_NODE:
+	case XML_PI_NODE:
+	case XML_COMMENT_NODE:
+	    break;
+	case XML_DOCUMENT_FRAG_NODE:
+	    /* TODO: Support document-fragment-nodes. */
+	    return (2);
+	default:
+	    return (1);
+    }
+    /*
+    * Unlink only if @node was not already added to @destParent.
+    */
+    if ((node->parent != NULL) && (destParent != node->parent))
+	xmlUnlinkNodeInternal(node);
+
+    if (node->type == XML_ELEMENT_NODE) {
+	    return (xmlDOMWrapAdoptBranch(ctxt, sourceDoc, node,
+		    destDoc, destParent, options));
+    } else if (node->type == XML_ATTRIBUTE_NODE) {
+	    return (xmlDOMWrapAdoptAttr(ctxt, sourceDoc,
+		(xmlAttrPtr) node, destDoc, destParent, options));
+    } else {
+        if (node->doc != destDoc) {
+            if (xmlNodeSetDoc(node, destDoc) < 0)
+                ret = -1;
+        }
+    }
+    return (ret);
+}
+
+/************************************************************************
+ *									*
+ *			Element name index				*
+ *									*
+ ************************************************************************/
+
+typedef struct {
+    xmlNodePtr *nodes;
+    int *orders;
+    int nbNodes;
+    int maxNodes;
+    /* (attribute name, namespace URI) -> value hash, built lazily */
+    xmlHashTablePtr attrs;
+} xmlNameIndexEntry;
+
+typedef struct {
+    xmlNodePtr node;
+    int order;
+} xmlNameIndexPos;
+
+#define XML_CHILD_INDEX_SLOTS 4
+
+typedef struct {
+    xmlNodePtr parent;
+    /* all children */
+    xmlNodePtr *nodes;
+    int nbNodes;
+    /* element children */
+    xmlNodePtr *elems;
+    int nbElems;
+    int flags;
+} xmlChildIndex;
+
+typedef struct {
+    /* (name, namespace URI) -> xmlNameIndexEntry */
+    xmlHashTablePtr hash;
+    /* end of the subtree of each element by document order */
+    int *ends;
+    /* all elements sorted by address */
+    xmlNameIndexPos *pos;
+    int nbElems;
+    int maxElems;
+    /* all nodes sorted by address, see xmlDocIndexNodeOrder */
+    xmlNameIndexPos *order;
+    int nbOrder;
+    /* whether any entry has attribute value tables */
+    int hasValues;
+    /* child tables of wide nodes, see xmlDocIndexChildren */
+    xmlChildIndex *children[XML_CHILD_INDEX_SLOTS];
+    int nextChildSlot;
+    int hasChildren;
+    /* see xmlDocSetFrozen, all tables but value tables are built */
+    int frozen;
+    /* child tables of all wide nodes sorted by parent if frozen */
+    xmlChildIndex **wide;
+    int nbWide;
+    /* protects the value tables if frozen */
+    xmlMutex lock;
+} xmlNameIndex;
+
+static void
+xmlNameIndexFreeEntry(void *payload, const xmlChar *name);
+
+static void
+xmlNameIndexFreeValues(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlHashFree(payload, xmlNameIndexFreeEntry);
+}
+
+static void
+xmlNameIndexFreeEntry(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlNameIndexEntry *entry = payload;
+
+    xmlHashFree(entry->attrs, xmlNameIndexFreeValues);
+    xmlFree(entry->nodes);
+    xmlFree(entry->orders);
+    xmlFree(entry);
+}
+
+static void
+xmlNameIndexResetAttrs(void *payload, void *data ATTRIBUTE_UNUSED,
+                       const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlNameIndexEntry *entry = payload;
+
+    xmlHashFree(entry->attrs, xmlNameIndexFreeValues);
+    entry->attrs = NULL;
+}
+
+static void
+xmlChildIndexFree(xmlChildIndex *table) {
+    if (table == NULL)
+        return;
+    xmlFree(table->nodes);
+    xmlFree(table->elems);
+    xmlFree(table);
+}
+
+static void
+xmlChildIndexReset(xmlNameIndex *index) {
+    int i;
+
+    for (i = 0; i < XML_CHILD_INDEX_SLOTS; i++) {
+        xmlChildIndexFree(index->children[i]);
+        index->children[i] = NULL;
+    }
+    index->nextChildSlot = 0;
+    index->hasChildren = 0;
+}
+
+static void
+xmlNameIndexReset(xmlNameIndex *index) {
+    int i;
+
+    xmlChildIndexReset(index);
+    for (i = 0; i < index->nbWide; i++)
+        xmlChildIndexFree(index->wide[i]);
+    xmlFree(index->wide);
+    if (index->frozen)
+        xmlCleanupMutex(&index->lock);
+    xmlHashFree(index->hash, xmlNameIndexFreeEntry);
+    xmlFree(index->ends);
+    xmlFree(index->pos);
+    xmlFree(index->order);
+    memset(index, 0, sizeof(*index));
+}
+
+/**
+ * Unfreeze a document before it is modified. The complete index of
+ * a frozen document is discarded and rebuilt lazily.
+ *
+ * @param doc  the document with a name index
+ * @returns 1 if the document was frozen, 0 otherwise.
+ */
+static int
+xmlDocIndexThaw(xmlDocPtr doc) {
+    xmlNameIndex *index = doc->nameIndex;
+
+    if (!index->frozen)
+        return(0);
+    xmlNameIndexReset(index);
+    doc->properties &= ~XML_DOC_FROZEN;
+    return(1);
+}
+
+/**
+ * Discard the name index of a document after a change to its
+ * element structure. The index is rebuilt on the next lookup.
+ *
+ * @param doc  the document (optional)
+ */
+static void
+xmlDocIndexInvalidate(xmlDocPtr doc) {
+    xmlNameIndex *index;
+
+    if ((doc == NULL) || (doc->nameIndex == NULL))
+        return;
+    index = doc->nameIndex;
+    if ((xmlDocIndexThaw(doc) == 0) &&
+        ((index->hash != NULL) || (index->order != NULL) ||
+         (index->hasChildren)))
+        xmlNameIndexReset(index);
+}
+
+/**
+ * Discard the document order table and the child tables of the
+ * name index after nodes were added or removed.
+ *
+ * @param doc  the document (optional)
+ */
+static void
+xmlDocIndexOrderChanged(xmlDocPtr doc) {
+    xmlNameIndex *index;
+
+    if ((doc == NULL) || (doc->nameIndex == NULL) ||
+        (xmlDocIndexThaw(doc)))
+        return;
+    index = doc->nameIndex;
+    if (index->hasChildren)
+        xmlChildIndexReset(index);
+    if (index->order != NULL) {
+        xmlFree(index->order);
+        index->order = NULL;
+        index->nbOrder = 0;
+    }
+}
+
+/**
+ * Discard the attribute value tables of the name index of a
+ * document after an attribute was added, removed or changed.
+ *
+ * @param doc  the document (optional)
+ */
+static void
+xmlDocIndexInvalidateValues(xmlDocPtr doc) {
+    xmlNameIndex *index;
+
+    if ((doc == NULL) || (doc->nameIndex == NULL) ||
+        (xmlDocIndexThaw(doc)))
+        return;
+    index = doc->nameIndex;
+    if (index->hasValues) {
+        xmlHashScan(index->hash, xmlNameIndexResetAttrs, NULL);
+        index->hasValues = 0;
+    }
+}
+
+/**
+ * Discard the attribute value tables of the name index if `node`
+ * is an attribute or part of an attribute value.
+ *
+ * @param node  the node
+ */
+static void
+xmlDocIndexAttrChanged(xmlNodePtr node) {
+    if ((node->type == XML_ATTRIBUTE_NODE) ||
+        ((node->parent != NULL) &&
+         (node->parent->type == XML_ATTRIBUTE_NODE)))
+        xmlDocIndexInvalidateValues(node->doc);
+}
+
+/**
+ * Discard the name index of a document if an element in the node
+ * list starting with `node` is part of the indexed tree, and the
+ * document order table if the list is linked. Used when nodes are
+ * freed without being unlinked.
+ *
+ * @param node  the first node of a list
+ */
+static void
+xmlDocIndexRemoved(xmlNodePtr node) {
+    xmlNameIndex *index;
+    xmlNodePtr cur;
+
+    if ((node->doc == NULL) || (node->doc->nameIndex == NULL))
+        return;
+    if (node->parent != NULL)
+        xmlDocIndexOrderChanged(node->doc);
+    index = node->doc->nameIndex;
+    if (index->hash == NULL)
+        return;
+
+    for (cur = node; cur != NULL; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE)
+            break;
+    }
+    if (cur == NULL)
+        return;
+
+    for (cur = cur->parent; cur != NULL; cur = cur->parent) {
+        if (cur == (xmlNodePtr) node->doc) {
+            if (xmlDocIndexThaw(node->doc) == 0)
+                xmlNameIndexReset(index);
+            break;
+        }
+    }
+}
+
+static int
+xmlNameIndexPosCmp(const void *a, const void *b) {
+    uintptr_t na = (uintptr_t) ((const xmlNameIndexPos *) a)->node;
+    uintptr_t nb = (uintptr_t) ((const xmlNameIndexPos *) b)->node;
+
+    return((na > nb) - (na < nb));
+}
+
+static int
+xmlNameIndexEntryAdd(xmlNameIndexEntry *entry, xmlNodePtr node, int order) {
+    if (entry->nbNodes >= entry->maxNodes) {
+        xmlNodePtr *nodes;
+        int *orders;
+        int newSize;
+
+        newSize = xmlGrowCapacity(entry->maxNodes, sizeof(nodes[0]),
+                                  4, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        nodes = xmlRealloc(entry->nodes, newSize * sizeof(nodes[0]));
+        if (nodes == NULL)
+            return(-1);
+        entry->nodes = nodes;
+        orders = xmlRealloc(entry->orders, newSize * sizeof(orders[0]));
+        if (orders == NULL)
+            return(-1);
+        entry->orders = orders;
+        entry->maxNodes = newSize;
+    }
+
+    entry->nodes[entry->nbNodes] = node;
+    entry->orders[entry->nbNodes] = order;
+    entry->nbNodes += 1;
+
+    return(0);
+}
+
+static int
+xmlNameIndexAdd(xmlNameIndex *index, xmlNodePtr node) {
+    xmlNameIndexEntry *entry;
+    const xmlChar *href;
+    int order = index->nbElems;
+
+    if (index->nbElems >= index->maxElems) {
+        xmlNameIndexPos *pos;
+        int *ends;
+        int newSize;
+
+        newSize = xmlGrowCapacity(index->maxElems, sizeof(pos[0]),
+                                  64, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        pos = xmlRealloc(index->pos, newSize * sizeof(pos[0]));
+        if (pos == NULL)
+            return(-1);
+        index->pos = pos;
+        ends = xmlRealloc(index->ends, newSize * sizeof(ends[0]));
+        if (ends == NULL)
+            return(-1);
+        index->ends = ends;
+        index->maxElems = newSize;
+    }
+
+    href = (node->ns != NULL) ? node->ns->href : NULL;
+    entry = xmlHashLookup2(index->hash, node->name, href);
+    if (entry == NULL) {
+        entry = xmlMalloc(sizeof(*entry));
+        if (entry == NULL)
+            return(-1);
+        memset(entry, 0, sizeof(*entry));
+        if (xmlHashAdd2(index->hash, node->name, href, entry) < 0) {
+            xmlFree(entry);
+            return(-1);
+        }
+    }
+
+    if (xmlNameIndexEntryAdd(entry, node, order) < 0)
+        return(-1);
+
+    index->pos[order].node = node;
+    index->pos[order].order = order;
+    index->ends[order] = order + 1;
+    index->nbElems += 1;
+
+    return(0);
+}
+
+/**
+ * Build the name index of a document. Elements are visited in
+ * document order, like the descendant axis of XPath: DTD nodes
+ * and the content of entity references are skipped.
+ *
+ * @param doc  the document
+ * @param index  an empty index
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+xmlNameIndexBuild(xmlDocPtr doc, xmlNameIndex *index) {
+    xmlNodePtr cur;
+    int *stack = NULL;
+    int depth = 0, maxDepth = 0;
+
+    index->hash = xmlHashCreateDict(0, doc->dict);
+    if (index->hash == NULL)
+        return(-1);
+
+    cur = doc->children;
+    while (cur != NULL) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            if ((cur->name != NULL) && (xmlNameIndexAdd(index, cur) < 0))
+                goto error;
+
+            if (cur->children != NULL) {
+                if (depth >= maxDepth) {
+                    int *tmp;
+                    int newSize;
+
+                    newSize = xmlGrowCapacity(maxDepth, sizeof(tmp[0]),
+                                              16, XML_MAX_ITEMS);
+                    if (newSize < 0)
+                        goto error;
+                    tmp = xmlRealloc(stack, newSize * sizeof(tmp[0]));
+                    if (tmp == NULL)
+                        goto error;
+                    stack = tmp;
+                    maxDepth = newSize;
+                }
+                stack[depth++] = cur->name != NULL ? index->nbElems - 1 : -1;
+                cur = cur->children;
+                continue;
+            }
+        }
+
+        while ((cur->next == NULL) && (depth > 0)) {
+            cur = cur->parent;
+            depth -= 1;
+            if (stack[depth] >= 0)
+                index->ends[stack[depth]] = index->nbElems;
+        }
+        cur = cur->next;
+    }
+
+    xmlFree(stack);
+
+    if (index->nbElems > 1)
+        qsort(index->pos, index->nbElems, sizeof(index->pos[0]),
+              xmlNameIndexPosCmp);
+
+    return(0);
+
+error:
+    xmlFree(stack);
+    xmlNameIndexReset(index);
+    return(-1);
+}
+
+/**
+ * Find the range of document order positions covering the
+ * descendants of `node`, building the index if needed.
+ *
+ * @param node  the context node, an element or a document
+ * @param self  whether to include `node` itself
+ * @param startPtr  pointer to the first position
+ * @param endPtr  pointer to the position after the last descendant
+ * @returns the index or NULL if the document has no index or `node`
+ * isn't part of the indexed tree.
+ */
+static xmlNameIndex *
+xmlNameIndexRange(xmlNodePtr node, int self, int *startPtr, int *endPtr) {
+    xmlNameIndex *index;
+    int start, lo, hi;
+
+    if ((node == NULL) ||
+        ((node->type != XML_ELEMENT_NODE) &&
+         (node->type != XML_DOCUMENT_NODE) &&
+         (node->type != XML_HTML_DOCUMENT_NODE)) ||
+        (node->doc == NULL) || (node->doc->nameIndex == NULL))
+        return(NULL);
+    index = node->doc->nameIndex;
+
+    if (index->hash == NULL) {
+        if (xmlNameIndexBuild(node->doc, index) < 0)
+            return(NULL);
+    }
+
+    if (node == (xmlNodePtr) node->doc) {
+        *startPtr = 0;
+        *endPtr = index->nbElems;
+        return(index);
+    }
+    if (node->type != XML_ELEMENT_NODE)
+        return(NULL);
+
+    lo = 0;
+    hi = index->nbElems;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if ((uintptr_t) index->pos[mid].node < (uintptr_t) node)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if ((lo >= index->nbElems) || (index->pos[lo].node != node))
+        return(NULL);
+    start = index->pos[lo].order;
+    *endPtr = index->ends[start];
+    *startPtr = self ? start : start + 1;
+
+    return(index);
+}
+
+/**
+ * Return the nodes of an entry between two document order
+ * positions.
+ */
+static void
+xmlNameIndexSlice(xmlNameIndexEntry *entry, int start, int end,
+                  xmlNodePtr **nodes, int *nb) {
+    int lo, hi;
+
+    if (entry == NULL) {
+        *nodes = NULL;
+        *nb = 0;
+        return;
+    }
+
+    lo = 0;
+    hi = entry->nbNodes;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (entry->orders[mid] < start)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    start = lo;
+    hi = entry->nbNodes;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (entry->orders[mid] < end)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *nodes = entry->nodes + start;
+    *nb = lo - start;
+}
+
+/**
+ * Build the table mapping the values of an attribute to the
+ * elements of an entry.
+ *
+ * @param entry  the element entry
+ * @param name  the local name of the attribute
+ * @param href  the namespace URI of the attribute (optional)
+ * @returns the value table or NULL if a memory allocation failed.
+ */
+static xmlHashTablePtr
+xmlNameIndexBuildValues(xmlNameIndexEntry *entry, const xmlChar *name,
+                        const xmlChar *href) {
+    xmlHashTablePtr values;
+    int i;
+
+    values = xmlHashCreate(0);
+    if (values == NULL)
+        return(NULL);
+
+    for (i = 0; i < entry->nbNodes; i++) {
+        xmlNodePtr node = entry->nodes[i];
+        xmlAttrPtr attr;
+
+        for (attr = node->properties; attr != NULL; attr = attr->next) {
+            xmlNameIndexEntry *list;
+            xmlChar *value;
+
+            if (!xmlStrEqual(attr->name, name))
+                continue;
+            if (href == NULL) {
+                if (attr->ns != NULL)
+                    continue;
+            } else if ((attr->ns == NULL) ||
+                       (!xmlStrEqual(attr->ns->href, href))) {
+                continue;
+            }
+
+            value = xmlNodeGetContent((xmlNodePtr) attr);
+            if (value == NULL)
+                goto error;
+
+            list = xmlHashLookup(values, value);
+            if (list == NULL) {
+                list = xmlMalloc(sizeof(*list));
+                if (list == NULL) {
+                    xmlFree(value);
+                    goto error;
+                }
+                memset(list, 0, sizeof(*list));
+                if (xmlHashAdd(values, value, list) < 0) {
+                    xmlFree(list);
+                    xmlFree(value);
+                    goto error;
+                }
+            }
+            xmlFree(value);
+
+            /* Duplicate attributes can only match once */
+            if ((list->nbNodes > 0) &&
+                (list->nodes[list->nbNodes - 1] == node))
+                continue;
+            if (xmlNameIndexEntryAdd(list, node, entry->orders[i]) < 0)
+                goto error;
+        }
+    }
+
+    return(values);
+
+error:
+    xmlHashFree(values, xmlNameIndexFreeEntry);
+    return(NULL);
+}
+
+/**
+ * Look up the value table of an element and attribute name,
+ * building it if needed.
+ *
+ * @param index  the name index
+ * @param entry  the index entry of the element name
+ * @param dict  the dictionary of the document
+ * @param name  the local name of the attribute
+ * @param href  the namespace URI of the attribute (optional)
+ * @returns the value table or NULL if a memory allocation failed.
+ */
+static xmlHashTablePtr
+xmlNameIndexGetValues(xmlNameIndex *index, xmlNameIndexEntry *entry,
+                      xmlDictPtr dict, const xmlChar *name,
+                      const xmlChar *href) {
+    xmlHashTablePtr values;
+
+    if (entry->attrs == NULL) {
+        /* The dictionary of a frozen document isn't modified */
+        entry->attrs = xmlHashCreateDict(0, index->frozen ? NULL : dict);
+        if (entry->attrs == NULL)
+            return(NULL);
+        index->hasValues = 1;
+    }
+    values = xmlHashLookup2(entry->attrs, name, href);
+    if (values == NULL) {
+        values = xmlNameIndexBuildValues(entry, name, href);
+        if (values == NULL)
+            return(NULL);
+        if (xmlHashAdd2(entry->attrs, name, href, values) < 0) {
+            xmlHashFree(values, xmlNameIndexFreeEntry);
+            return(NULL);
+        }
+    }
+
+    return(values);
+}
+
+/**
+ * Look up the elements with a given name on the descendant axis
+ * of `node` in the name index of its document. The index is built
+ * if needed.
+ *
+ * On success, `nodes` points to an array of `nb` elements in
+ * document order. The array is owned by the index and only valid
+ * until the document is modified.
+ *
+ * @param node  the context node, an element or a document
+ * @param name  the local name
+ * @param href  the namespace URI (optional)
+ * @param self  whether to include `node` itself
+ * @param nodes  pointer to the resulting array
+ * @param nb  pointer to the number of elements
+ * @returns 0 on success, -1 if the document has no index or `node`
+ * isn't part of the indexed tree.
+ */
+int
+xmlDocIndexLookup(xmlNode *node, const xmlChar *name, const xmlChar *href,
+                  int self, xmlNode ***nodes, int *nb) {
+    xmlNameIndex *index;
+    int start, end;
+
+    if (name == NULL)
+        return(-1);
+    index = xmlNameIndexRange(node, self, &start, &end);
+    if (index == NULL)
+        return(-1);
+
+    xmlNameIndexSlice(xmlHashLookup2(index->hash, name, href),
+                      start, end, nodes, nb);
+    return(0);
+}
+
+/**
+ * Like #xmlDocIndexLookup, but only return elements with an
+ * attribute of the given name whose string value equals `value`.
+ * The table of values for an element and attribute name is built
+ * on the first lookup and kept until an attribute in the document
+ * is changed.
+ *
+ * @param node  the context node, an element or a document
+ * @param name  the local name of the elements
+ * @param href  the namespace URI of the elements (optional)
+ * @param attrName  the local name of the attribute
+ * @param attrHref  the namespace URI of the attribute (optional)
+ * @param value  the attribute value
+ * @param self  whether to include `node` itself
+ * @param nodes  pointer to the resulting array
+ * @param nb  pointer to the number of elements
+ * @returns 0 on success, -1 if the document has no index, `node`
+ * isn't part of the indexed tree or a memory allocation failed.
+ */
+int
+xmlDocIndexLookupValue(xmlNode *node, const xmlChar *name,
+                       const xmlChar *href, const xmlChar *attrName,
+                       const xmlChar *attrHref, const xmlChar *value,
+                       int self, xmlNode ***nodes, int *nb) {
+    xmlNameIndex *index;
+    xmlNameIndexEntry *entry;
+    xmlHashTablePtr values;
+    int start, end;
+
+    if ((name == NULL) || (attrName == NULL) || (value == NULL))
+        return(-1);
+    index = xmlNameIndexRange(node, self, &start, &end);
+    if (index == NULL)
+        return(-1);
+
+    entry = xmlHashLookup2(index->hash, name, href);
+    if (entry == NULL) {
+        *nodes = NULL;
+        *nb = 0;
+        return(0);
+    }
+
+    /* Value tables of frozen documents can be built concurrently */
+    if (index->frozen)
+        xmlMutexLock(&index->lock);
+    values = xmlNameIndexGetValues(index, entry, node->doc->dict,
+                                   attrName, attrHref);
+    if (index->frozen)
+        xmlMutexUnlock(&index->lock);
+    if (values == NULL)
+        return(-1);
+
+    xmlNameIndexSlice(xmlHashLookup(values, value), start, end, nodes, nb);
+    return(0);
+}
+
+static int
+xmlNameIndexAddOrder(xmlNameIndex *index, xmlNodePtr node, int *max) {
+    if (index->nbOrder >= *max) {
+        xmlNameIndexPos *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(*max, sizeof(tmp[0]), 256, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(index->order, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        index->order = tmp;
+        *max = newSize;
+    }
+
+    index->order[index->nbOrder].node = node;
+    index->order[index->nbOrder].order = index->nbOrder;
+    index->nbOrder += 1;
+
+    return(0);
+}
+
+/**
+ * Build the document order table of a document. The document node,
+ * elements, attributes and other children are numbered in XPath
+ * document order. Attribute values, the content of entity references
+ * and DTD nodes aren't numbered.
+ *
+ * @param doc  the document
+ * @param index  the index
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+xmlNameIndexBuildOrder(xmlDocPtr doc, xmlNameIndex *index) {
+    xmlNodePtr cur;
+    int max = 0;
+
+    if (xmlNameIndexAddOrder(index, (xmlNodePtr) doc, &max) < 0)
+        goto error;
+
+    cur = doc->children;
+    while (cur != NULL) {
+        if (xmlNameIndexAddOrder(index, cur, &max) < 0)
+            goto error;
+
+        if (cur->type == XML_ELEMENT_NODE) {
+            xmlAttrPtr attr;
+
+            for (attr = cur->properties; attr != NULL; attr = attr->next) {
+                if (xmlNameIndexAddOrder(index, (xmlNodePtr) attr, &max) < 0)
+                    goto error;
+            }
+
+            if (cur->children != NULL) {
+                cur = cur->children;
+                continue;
+            }
+        }
+
+        while ((cur != (xmlNodePtr) doc) && (cur->next == NULL))
+            cur = cur->parent;
+        if (cur == (xmlNodePtr) doc)
+            break;
+        cur = cur->next;
+    }
+
+    if (index->nbOrder > 1)
+        qsort(index->order, index->nbOrder, sizeof(index->order[0]),
+              xmlNameIndexPosCmp);
+
+    return(0);
+
+error:
+    xmlFree(index->order);
+    index->order = NULL;
+    index->nbOrder = 0;
+    return(-1);
+}
+
+/**
+ * Look up the document order of nodes in the document order table
+ * of their document. The table is built if needed.
+ *
+ * On success, `keys` contains a number for each node which is
+ * unique in the document and increases in document order.
+ *
+ * @param nodes  an array of nodes
+ * @param nb  the number of nodes
+ * @param keys  an array of `nb` integers receiving the keys
+ * @returns 0 on success, -1 if the document has no index, a node
+ * isn't part of the indexed tree or isn't numbered, or a memory
+ * allocation failed.
+ */
+int
+xmlDocIndexNodeOrder(xmlNode **nodes, int nb, int *keys) {
+    xmlNameIndex *index;
+    xmlDocPtr doc;
+    int i;
+
+    if ((nodes == NULL) || (nb <= 0) ||
+        (nodes[0]->type == XML_NAMESPACE_DECL) ||
+        (nodes[0]->doc == NULL) || (nodes[0]->doc->nameIndex == NULL))
+        return(-1);
+    doc = nodes[0]->doc;
+    index = doc->nameIndex;
+
+    if (index->order == NULL) {
+        if (xmlNameIndexBuildOrder(doc, index) < 0)
+            return(-1);
+    }
+
+    for (i = 0; i < nb; i++) {
+        xmlNodePtr node = nodes[i];
+        int lo = 0, hi = index->nbOrder;
+
+        if ((node->type == XML_NAMESPACE_DECL) || (node->doc != doc))
+            return(-1);
+
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+
+            if ((uintptr_t) index->order[mid].node < (uintptr_t) node)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if ((lo >= index->nbOrder) || (index->order[lo].node != node))
+            return(-1);
+        keys[i] = index->order[lo].order;
+    }
+
+    return(0);
+}
+
+/*
+ * Build the child table of `parent` if it has at least
+ * XML_CHILD_INDEX_MIN children.
+ */
+static xmlChildIndex *
+xmlChildIndexBuild(xmlNodePtr parent) {
+    xmlChildIndex *table;
+    xmlNodePtr cur;
+    xmlNodePtr *nodes = NULL, *elems = NULL;
+    const xmlChar *name = NULL, *href = NULL;
+    int nbNodes = 0, nbElems = 0;
+    int flags = XML_CHILD_INDEX_PLAIN | XML_CHILD_INDEX_UNIFORM;
+
+    for (cur = parent->children; cur != NULL; cur = cur->next) {
+        if (cur->type == XML_ELEMENT_NODE)
+            nbElems++;
+        nbNodes++;
+        if (nbNodes >= XML_MAX_ITEMS)
+            return(NULL);
+    }
+    if (nbNodes < XML_CHILD_INDEX_MIN)
+        return(NULL);
+
+    table = xmlMalloc(sizeof(*table));
+    nodes = xmlMalloc(nbNodes * sizeof(nodes[0]));
+    if (nbElems > 0)
+        elems = xmlMalloc(nbElems * sizeof(elems[0]));
+    if ((table == NULL) || (nodes == NULL) ||
+        ((nbElems > 0) && (elems == NULL))) {
+        xmlFree(table);
+        xmlFree(nodes);
+        xmlFree(elems);
+        return(NULL);
+    }
+
+    nbNodes = 0;
+    nbElems = 0;
+    for (cur = parent->children; cur != NULL; cur = cur->next) {
+        switch (cur->type) {
+            case XML_ELEMENT_NODE: {
+                const xmlChar *elemHref;
+
+                elemHref = (cur->ns != NULL) ? cur->ns->href : NULL;
+                if (nbElems == 0) {
+                    name = cur->name;
+                    href = elemHref;
+                } else if ((!xmlStrEqual(name, cur->name)) ||
+                           (!xmlStrEqual(href, elemHref))) {
+                    flags &= ~XML_CHILD_INDEX_UNIFORM;
+                }
+                elems[nbElems++] = cur;
+                break;
+            }
+
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+            case XML_PI_NODE:
+            case XML_COMMENT_NODE:
+                break;
+
+            default:
+                flags &= ~XML_CHILD_INDEX_PLAIN;
+                break;
+        }
+        nodes[nbNodes++] = cur;
+    }
+
+    table->parent = parent;
+    table->nodes = nodes;
+    table->nbNodes = nbNodes;
+    table->elems = elems;
+    table->nbElems = nbElems;
+    table->flags = flags;
+
+    return(table);
+}
+
+/*
+ * Look up the child table of `parent`, building it if `parent` has
+ * at least XML_CHILD_INDEX_MIN children. Tables are kept in a few
+ * slots which are reused round-robin. A frozen index has the tables
+ * of all wide nodes.
+ */
+static xmlChildIndex *
+xmlChildIndexGet(xmlNameIndex *index, xmlNodePtr parent) {
+    xmlChildIndex *table;
+    int i;
+
+    if (index->frozen) {
+        int lo = 0, hi = index->nbWide;
+
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+
+            if ((uintptr_t) index->wide[mid]->parent < (uintptr_t) parent)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if ((lo < index->nbWide) && (index->wide[lo]->parent == parent))
+            return(index->wide[lo]);
+        return(NULL);
+    }
+
+    for (i = 0; i < XML_CHILD_INDEX_SLOTS; i++) {
+        if ((index->children[i] != NULL) &&
+            (index->children[i]->parent == parent))
+            return(index->children[i]);
+    }
+
+    table = xmlChildIndexBuild(parent);
+    if (table == NULL)
+        return(NULL);
+
+    i = index->nextChildSlot;
+    xmlChildIndexFree(index->children[i]);
+    index->children[i] = table;
+    index->nextChildSlot = (i + 1) % XML_CHILD_INDEX_SLOTS;
+    index->hasChildren = 1;
+
+    return(table);
+}
+
+/**
+ * Look up the children of a node in the child index of its
+ * document. The index is built lazily for nodes with at least
+ * XML_CHILD_INDEX_MIN children and discarded when nodes are added
+ * or removed.
+ *
+ * @param parent  an element, document or document fragment
+ * @param elements  whether to return element children only
+ * @param nodes  pointer to the array of children
+ * @param nb  pointer to the number of children
+ * @param flags  pointer to XML_CHILD_INDEX_* flags (optional)
+ * @returns 0 on success, -1 if the document has no index, `parent`
+ * has too few children or a memory allocation failed.
+ */
+int
+xmlDocIndexChildren(xmlNode *parent, int elements, xmlNode ***nodes,
+                    int *nb, int *flags) {
+    xmlChildIndex *table;
+
+    if ((parent == NULL) ||
+        ((parent->type != XML_ELEMENT_NODE) &&
+         (parent->type != XML_DOCUMENT_NODE) &&
+         (parent->type != XML_HTML_DOCUMENT_NODE) &&
+         (parent->type != XML_DOCUMENT_FRAG_NODE)) ||
+        (parent->doc == NULL) || (parent->doc->nameIndex == NULL))
+        return(-1);
+
+    table = xmlChildIndexGet(parent->doc->nameIndex, parent);
+    if (table == NULL)
+        return(-1);
+
+    if (elements) {
+        *nodes = table->elems;
+        *nb = table->nbElems;
+    } else {
+        *nodes = table->nodes;
+        *nb = table->nbNodes;
+    }
+    if (flags != NULL)
+        *flags = table->flags;
+
+    return(0);
+}
+
+static int
+xmlChildIndexParentCmp(const void *a, const void *b) {
+    uintptr_t pa = (uintptr_t) (*(xmlChildIndex * const *) a)->parent;
+    uintptr_t pb = (uintptr_t) (*(xmlChildIndex * const *) b)->parent;
+
+    return((pa > pb) - (pa < pb));
+}
+
+static int
+xmlNameIndexAddWide(xmlNameIndex *index, xmlNodePtr parent, int *max) {
+    xmlChildIndex *table;
+    xmlNodePtr cur;
+    int nb = 0;
+
+    for (cur = parent->children; cur != NULL; cur = cur->next) {
+        if (++nb >= XML_CHILD_INDEX_MIN)
+            break;
+    }
+    if (nb < XML_CHILD_INDEX_MIN)
+        return(0);
+
+    if (index->nbWide >= *max) {
+        xmlChildIndex **tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(*max, sizeof(tmp[0]), 16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(index->wide, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        index->wide = tmp;
+        *max = newSize;
+    }
+
+    table = xmlChildIndexBuild(parent);
+    if (table == NULL)
+        return(-1);
+    index->wide[index->nbWide++] = table;
+
+    return(0);
+}
+
+/**
+ * Build the child tables of all nodes of a document with at least
+ * XML_CHILD_INDEX_MIN children.
+ *
+ * @param doc  the document
+ * @param index  the index
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+xmlNameIndexBuildWide(xmlDocPtr doc, xmlNameIndex *index) {
+    xmlNodePtr cur;
+    int max = 0;
+
+    if (xmlNameIndexAddWide(index, (xmlNodePtr) doc, &max) < 0)
+        return(-1);
+
+    cur = doc->children;
+    while (cur != NULL) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            if (xmlNameIndexAddWide(index, cur, &max) < 0)
+                return(-1);
+
+            if (cur->children != NULL) {
+                cur = cur->children;
+                continue;
+            }
+        }
+
+        while ((cur != (xmlNodePtr) doc) && (cur->next == NULL))
+            cur = cur->parent;
+        if (cur == (xmlNodePtr) doc)
+            break;
+        cur = cur->next;
     }
-    goto exit;
 
-internal_error:
-    ret = -1;
+    if (index->nbWide > 1)
+        qsort(index->wide, index->nbWide, sizeof(index->wide[0]),
+              xmlChildIndexParentCmp);
 
-exit:
-    /*
-    * Cleanup.
-    */
-    if (nsMap != NULL) {
-	if ((ctxt) && (ctxt->namespaceMap == nsMap)) {
-	    /*
-	    * Just cleanup the map but don't free.
-	    */
-	    if (nsMap->first) {
-		if (nsMap->pool)
-		    nsMap->last->next = nsMap->pool;
-		nsMap->pool = nsMap->first;
-		nsMap->first = NULL;
-	    }
-	} else
-	    xmlDOMWrapNsMapFree(nsMap);
-    }
-    /*
-    * TODO: Should we try a cleanup of the cloned node in case of a
-    * fatal error?
-    */
-    *resNode = resultClone;
-    return (ret);
+    return(0);
 }
 
 /**
- * `attr` is adopted by `destDoc`.
- * Ensures that ns-references point to `destDoc`: either to
- * `elements->nsDef` entries if `destParent` is given, or to
- * `destDoc->oldNs` otherwise.
+ * Freeze or unfreeze a document for concurrent XPath evaluation.
  *
- * @param ctxt  the optional context for custom processing
- * @param sourceDoc  unused
- * @param attr  the attribute-node to be adopted
- * @param destDoc  the destination doc for adoption
- * @param destParent  the optional new parent of `attr` in `destDoc`
- * @param options  option flags (unused)
- * @returns 0 if succeeded, -1 otherwise and on API/internal errors.
+ * Freezing enables the name index of the document (see
+ * #xmlDocSetNameIndex) and builds it completely, except for the
+ * tables of attribute values which are built on demand under a
+ * lock. Multiple threads can then evaluate XPath expressions on
+ * the document at the same time, each with its own XPath context
+ * and compiled expressions. Evaluation doesn't write to a frozen
+ * document or its dictionary, and #xmlXPathOrderDocElems fails.
+ *
+ * ID attributes of documents parsed with lazy IDs are added to the
+ * ID table first, so id() doesn't modify the document either.
+ *
+ * A frozen document has the XML_DOC_FROZEN property. It must not
+ * be modified while other threads read it. Modifying it with the
+ * functions of this module unfreezes it.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  the document
+ * @param frozen  1 to freeze, 0 to unfreeze
+ * @returns 0 on success or -1 if a memory allocation failed.
+ * The document isn't frozen on failure.
  */
-static int
-xmlDOMWrapAdoptAttr(xmlDOMWrapCtxtPtr ctxt,
-		    xmlDocPtr sourceDoc ATTRIBUTE_UNUSED,
-		    xmlAttrPtr attr,
-		    xmlDocPtr destDoc,
-		    xmlNodePtr destParent,
-		    int options ATTRIBUTE_UNUSED)
-{
-    int ret = 0;
+int
+xmlDocSetFrozen(xmlDoc *doc, int frozen) {
+    xmlNameIndex *index;
 
-    if ((attr == NULL) || (destDoc == NULL))
-	return (-1);
+    if (doc == NULL)
+        return(-1);
 
-    if (attr->doc != destDoc) {
-        if (xmlSetTreeDoc((xmlNodePtr) attr, destDoc) < 0)
-            ret = -1;
+    if (!frozen) {
+        if (doc->nameIndex != NULL)
+            xmlDocIndexThaw(doc);
+        doc->properties &= ~XML_DOC_FROZEN;
+        return(0);
     }
 
-    if (attr->ns != NULL) {
-	xmlNsPtr ns = NULL;
+    if ((doc->properties & XML_DOC_LAZY_IDS) &&
+        (xmlCollectLazyIds(doc) < 0))
+        return(-1);
 
-	if (ctxt != NULL) {
-	    /* TODO: User defined. */
-	}
-	/* XML Namespace. */
-	if (IS_STR_XML(attr->ns->prefix)) {
-	    ns = xmlTreeEnsureXMLDecl(destDoc);
-	} else if (destParent == NULL) {
-	    /*
-	    * Store in @destDoc->oldNs.
-	    */
-	    ns = xmlDOMWrapStoreNs(destDoc, attr->ns->href, attr->ns->prefix);
-	} else {
-	    /*
-	    * Declare on @destParent.
-	    */
-	    if (xmlSearchNsByNamespaceStrict(destDoc, destParent, attr->ns->href,
-		&ns, 1) == -1)
-		ret = -1;
-	    if (ns == NULL) {
-		ns = xmlDOMWrapNSNormDeclareNsForced(destDoc, destParent,
-		    attr->ns->href, attr->ns->prefix, 1);
-	    }
-	}
-	if (ns == NULL)
-	    ret = -1;
-	attr->ns = ns;
+    if (xmlDocSetNameIndex(doc, 1) < 0)
+        return(-1);
+    index = doc->nameIndex;
+
+    if ((xmlNameIndexBuild(doc, index) < 0) ||
+        (xmlNameIndexBuildOrder(doc, index) < 0) ||
+        (xmlNameIndexBuildWide(doc, index) < 0)) {
+        xmlNameIndexReset(index);
+        return(-1);
     }
 
-    return (ret);
+    xmlInitMutex(&index->lock);
+    index->frozen = 1;
+    doc->properties |= XML_DOC_FROZEN;
+
+    return(0);
 }
 
 /**
- * Fix up namespaces before moving a node.
+ * Enable or disable the element name index of a document.
  *
- * References of out-of scope ns-decls are remapped to point to `destDoc`:
- * If `destParent` is given, then nsDef entries on element-nodes are used.
- * If *no* `destParent` is given, then `destDoc->oldNs` entries are used
- * This is the case when you have an unlinked node and just want to move it
- * to the context of.
+ * The index maps the local name and namespace URI of elements to
+ * the matching elements in document order. It is built lazily on
+ * the first lookup and lets XPath evaluate steps like `//name` or
+ * `descendant::name` without walking the whole tree. Steps with a
+ * predicate like `[@attr = 'value']` additionally use a table of
+ * attribute values which is built the first time an element and
+ * attribute name are queried. Large node-sets are sorted and merged
+ * with a table numbering all nodes in document order. Positional
+ * child steps like `child::rec[1000]` or `(rec)[last()]` and
+ * #xmlNthChild use arrays of the children of nodes with many
+ * children which are built on first access.
  *
- * If `destParent` is given, it ensures that the tree is namespace
- * wellformed by creating additional ns-decls where needed.
- * Note that, since prefixes of already existent ns-decls can be
- * shadowed by this process, it could break QNames in attribute
- * values or element content.
+ * The index is discarded whenever the element structure or the
+ * attributes of the document are changed with the functions in
+ * this module. Code that links nodes or changes names, namespaces
+ * or text content directly must call this function again to
+ * discard a stale index. Documents
+ * which are still being built by the parser or modified by an
+ * xmlTextReader shouldn't be indexed.
  *
- * NOTE: This function was not intensively tested.
+ * Calling this function with `enable` set to 1 always discards the
+ * current index.
  *
- * @param ctxt  the optional context for custom processing
- * @param sourceDoc  the optional sourceDoc
- * @param node  the node to start with
- * @param destDoc  the destination doc
- * @param destParent  the optional new parent of `node` in `destDoc`
- * @param options  option flags
- * @returns 0 if the operation succeeded,
- *          1 if a node of unsupported type was given,
- *          2 if a node of not yet supported type was given and
- *          -1 on API/internal errors.
+ * @since 2.16.0
+ *
+ * @param doc  the document
+ * @param enable  1 to enable the index, 0 to disable it
+ * @returns 0 on success or -1 if `doc` is NULL or a memory
+ * allocation failed.
  */
 int
-xmlDOMWrapAdoptNode(xmlDOMWrapCtxt *ctxt,
-		    xmlDoc *sourceDoc,
-		    xmlNode *node,
-		    xmlDoc *destDoc,
-		    xmlNode *destParent,
-		    int options)
-{
-    int ret = 0;
+xmlDocSetNameIndex(xmlDoc *doc, int enable) {
+    xmlNameIndex *index;
 
-    if ((node == NULL) || (node->type == XML_NAMESPACE_DECL) ||
-        (destDoc == NULL) ||
-	((destParent != NULL) && (destParent->doc != destDoc)))
-	return(-1);
-    /*
-    * Check node->doc sanity.
-    */
-    if (sourceDoc == NULL) {
-        sourceDoc = node->doc;
-    } else if (node->doc != sourceDoc) {
-	return (-1);
+    if (doc == NULL)
+        return(-1);
+
+    doc->properties &= ~XML_DOC_FROZEN;
+    if (doc->nameIndex != NULL) {
+        xmlNameIndexReset(doc->nameIndex);
+        xmlFree(doc->nameIndex);
+        doc->nameIndex = NULL;
     }
 
-    /*
-     * TODO: Shouldn't this be allowed?
-     */
-    if (sourceDoc == destDoc)
-	return (-1);
+    if (enable) {
+        index = xmlMalloc(sizeof(*index));
+        if (index == NULL)
+            return(-1);
+        memset(index, 0, sizeof(*index));
+        doc->nameIndex = index;
+    }
 
-    switch (node->type) {
-	case XML_ELEMENT_NODE:
-	case XML_ATTRIBUTE_NODE:
-	case XML_TEXT_NODE:
-	case XML_CDATA_SECTION_NODE:
-	case XML_ENTITY_REF_NODE:
-	case XML_PI_NODE:
-	case XML_COMMENT_NODE:
-	    break;
-	case XML_DOCUMENT_FRAG_NODE:
-	    /* TODO: Support document-fragment-nodes. */
-	    return (2);
-	default:
-	    return (1);
+    return(0);
+}
+
+/************************************************************************
+ *									*
+ *			Source text					*
+ *									*
+ ************************************************************************/
+
+/**
+ * Free the source text of a document.
+ *
+ * @param src  the source text
+ */
+static void
+xmlDocSourceFree(xmlDocSource *src) {
+    if (src->release != NULL)
+        src->release(src->releaseCtxt);
+    else
+        xmlFree(src->text);
+    xmlFree(src->spans);
+    xmlFree(src);
+}
+
+/**
+ * Find the span of an element.
+ *
+ * @param src  the source text of a document
+ * @param node  the element
+ * @returns the span or NULL if the element has none.
+ */
+static xmlSourceSpan *
+xmlDocSourceLookup(xmlDocSource *src, const xmlNode *node) {
+    int lo = 0, hi = src->nbSpans;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const xmlNode *cur = src->spans[mid].node;
+
+        if (cur == node)
+            return(&src->spans[mid]);
+        if ((XML_INTPTR_T) cur < (XML_INTPTR_T) node)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    /*
-    * Unlink only if @node was not already added to @destParent.
-    */
-    if ((node->parent != NULL) && (destParent != node->parent))
-	xmlUnlinkNodeInternal(node);
 
-    if (node->type == XML_ELEMENT_NODE) {
-	    return (xmlDOMWrapAdoptBranch(ctxt, sourceDoc, node,
-		    destDoc, destParent, options));
-    } else if (node->type == XML_ATTRIBUTE_NODE) {
-	    return (xmlDOMWrapAdoptAttr(ctxt, sourceDoc,
-		(xmlAttrPtr) node, destDoc, destParent, options));
-    } else {
-        if (node->doc != destDoc) {
-            if (xmlNodeSetDoc(node, destDoc) < 0)
-                ret = -1;
+    return(NULL);
+}
+
+/**
+ * Invalidate the source text of all elements containing `node`
+ * after it was changed, added or removed. The walk stops at the
+ * first element which was already modified since its ancestors
+ * were invalidated at the same time.
+ *
+ * @param node  the changed node (optional)
+ */
+static void
+xmlNodeSourceChanged(xmlNodePtr node) {
+    xmlDocSource *src;
+    xmlSourceSpan *span;
+
+    if ((node == NULL) || (node->doc == NULL) || (node->doc->source == NULL))
+        return;
+    src = node->doc->source;
+
+    for (; node != NULL; node = node->parent) {
+        if (node->type != XML_ELEMENT_NODE) {
+            if ((node->type == XML_DOCUMENT_NODE) ||
+                (node->type == XML_HTML_DOCUMENT_NODE))
+                break;
+            continue;
+        }
+        span = xmlDocSourceLookup(src, node);
+        if (span != NULL) {
+            if (span->end == 0)
+                break;
+            span->end = 0;
         }
     }
-    return (ret);
+}
+
+/**
+ * Invalidate the source text of an element which is freed or moved
+ * to another document, so that a new node at the same address
+ * doesn't inherit it.
+ *
+ * @param doc  the document of the element
+ * @param node  the element
+ */
+static void
+xmlNodeSourceForget(xmlDocPtr doc, xmlNodePtr node) {
+    xmlSourceSpan *span;
+
+    if ((doc == NULL) || (doc->source == NULL))
+        return;
+    span = xmlDocSourceLookup(doc->source, node);
+    if (span != NULL)
+        span->end = 0;
+}
+
+/**
+ * Return the source text of an element of a document parsed with
+ * #xmlCtxtSetSourceSpans. The text starts with the start tag and
+ * ends with the end tag of the element and is encoded in UTF-8.
+ *
+ * Elements have no source text if they, their attributes or any
+ * of their descendants were changed with the functions in this
+ * module since the document was parsed. Code modifying the tree
+ * directly must call #xmlNodeMarkModified.
+ *
+ * @since 2.16.0
+ *
+ * @param node  an element
+ * @param len  pointer to the length of the text in bytes
+ * @returns a pointer into the source text owned by the document or
+ * NULL if the element has no unmodified source text.
+ */
+const xmlChar *
+xmlNodeGetSource(const xmlNode *node, size_t *len) {
+    xmlDocSource *src;
+    xmlSourceSpan *span;
+
+    if ((node == NULL) || (len == NULL) ||
+        (node->type != XML_ELEMENT_NODE) ||
+        (node->doc == NULL) || (node->doc->source == NULL))
+        return(NULL);
+
+    src = node->doc->source;
+    span = xmlDocSourceLookup(src, node);
+    if ((span == NULL) || (span->end == 0))
+        return(NULL);
+
+    *len = span->end - span->start;
+    return(src->text + span->start);
+}
+
+/**
+ * Mark a node as modified, so that the elements containing it are
+ * serialized from the tree instead of copying their source text.
+ * Only needed after changing node structs directly, see
+ * #xmlNodeGetSource.
+ *
+ * @since 2.16.0
+ *
+ * @param node  the modified node
+ */
+void
+xmlNodeMarkModified(xmlNode *node) {
+    xmlNodeSourceChanged(node);
+}
+
+/**
+ * Release the source text of a document parsed with
+ * #xmlCtxtSetSourceSpans. The document is serialized from the tree
+ * afterwards.
+ *
+ * @since 2.16.0
+ *
+ * @param doc  the document
+ */
+void
+xmlDocDiscardSource(xmlDoc *doc) {
+    if ((doc == NULL) || (doc->source == NULL))
+        return;
+    xmlDocSourceFree(doc->source);
+    doc->source = NULL;
 }
 
 /************************************************************************
@@ -1950,6 +1950,165 @@ err_memory:
     return(ret);
 }
 
+/*
+ * Characters of a path which xmlSaveUri writes back unchanged.
+ */
+#define IS_PLAIN_PATH_CHAR(x) (IS_UNRESERVED(x) || ((x) == '/') || \
+        ((x) == ';') || ((x) == '@') || ((x) == '&') || ((x) == '=') || \
+        ((x) == '+') || ((x) == '$') || ((x) == ','))
+
+/**
+ * Checks whether the base URI has the form scheme "://" host
+ * [ ":" port ] path [ "?" query ] [ "#" fragment ] with components
+ * which survive a round trip through the URI parser and xmlSaveUri
+ * unchanged.
+ *
+ * @param base  the base URI
+ * @param pathStart  set to the offset of the path
+ * @param pathEnd  set to the offset of the last '/' plus one, or to
+ * `pathStart` if the path is empty
+ * @returns 1 if the base URI is plain, 0 otherwise
+ */
+static int
+xmlIsPlainBaseURI(const xmlChar *base, int *pathStart, int *pathEnd) {
+    const xmlChar *cur = base;
+    const xmlChar *last = NULL;
+
+    if (!IS_ALPHA(*cur))
+        return(0);
+    cur++;
+    while (IS_ALPHANUM(*cur) || (*cur == '+') || (*cur == '-') ||
+           (*cur == '.'))
+        cur++;
+    if ((cur[0] != ':') || (cur[1] != '/') || (cur[2] != '/'))
+        return(0);
+    cur += 3;
+
+    while (IS_ALPHANUM(*cur) || (*cur == '-') || (*cur == '.') ||
+           (*cur == '_') || (*cur == '~'))
+        cur++;
+    if (*cur == ':') {
+        int digits = 0;
+
+        cur++;
+        if ((*cur < '1') || (*cur > '9'))
+            return(0);
+        while (IS_DIGIT(*cur) && (digits < 5)) {
+            cur++;
+            digits++;
+        }
+    }
+
+    *pathStart = cur - base;
+    if ((*cur != '/') && (*cur != '?') && (*cur != '#') && (*cur != 0))
+        return(0);
+    while (IS_PLAIN_PATH_CHAR(*cur)) {
+        if (*cur == '/')
+            last = cur;
+        cur++;
+    }
+    *pathEnd = (last != NULL) ? last + 1 - base : *pathStart;
+
+    /*
+     * Query and fragment of the base are dropped but must be valid.
+     */
+    if (*cur == '?') {
+        cur++;
+        while (IS_PLAIN_PATH_CHAR(*cur) || (*cur == ':') || (*cur == '?'))
+            cur++;
+    }
+    if (*cur == '#') {
+        cur++;
+        while (IS_PLAIN_PATH_CHAR(*cur) || (*cur == ':') || (*cur == '?'))
+            cur++;
+    }
+
+    return(*cur == 0);
+}
+
+/**
+ * Resolves common relative references without parsing URI and base
+ * into xmlURI structs. The only allocation is the result which is
+ * assembled from the unchanged parts of the inputs and normalized in
+ * place.
+ *
+ * Only handles references consisting of plain path characters and
+ * bases whose components would be serialized unchanged, so the result
+ * is identical to that of the generic code.
+ *
+ * @param URI  the reference, not empty
+ * @param base  the base value, not NULL
+ * @param valPtr  pointer to result URI
+ * @returns 0 on success, -1 if a memory allocation failed or 1 if the
+ * input isn't handled.
+ */
+static int
+xmlBuildURIFast(const xmlChar *URI, const xmlChar *base, xmlChar **valPtr) {
+    const xmlChar *cur;
+    xmlChar *val;
+    int refLen, prefixLen, pathStart, pathEnd;
+
+    if ((URI[0] == '/') && (URI[1] == '/'))
+        return(1);
+    for (cur = URI; *cur != 0; cur++) {
+        if (!IS_PLAIN_PATH_CHAR(*cur))
+            return(1);
+    }
+    refLen = cur - URI;
+
+    if (xmlStrstr(base, BAD_CAST "://") == NULL) {
+        /*
+         * Filesystem path, see xmlResolvePath. Without '%' or '#',
+         * the reference needs no unescaping.
+         */
+        if ((base[0] == 0) || (xmlIsAbsolutePath(URI))) {
+            prefixLen = 0;
+        } else {
+            prefixLen = xmlStrlen(base);
+            while ((prefixLen > 0) &&
+                   !xmlIsPathSeparator(base[prefixLen-1], 1))
+                prefixLen--;
+        }
+
+        val = xmlMalloc(prefixLen + refLen + 1);
+        if (val == NULL)
+            return(-1);
+        memcpy(val, base, prefixLen);
+        memcpy(val + prefixLen, URI, refLen + 1);
+        if (prefixLen > 0)
+            xmlNormalizePath((char *) val, 1);
+
+        *valPtr = val;
+        return(0);
+    }
+
+    if (!xmlIsPlainBaseURI(base, &pathStart, &pathEnd))
+        return(1);
+
+    /*
+     * Absolute paths replace the path of the base and aren't
+     * normalized. Relative paths are merged with the base path and
+     * need a leading '/' if the base path is empty.
+     */
+    if (URI[0] == '/')
+        prefixLen = pathStart;
+    else
+        prefixLen = pathEnd;
+
+    val = xmlMalloc(prefixLen + refLen + 2);
+    if (val == NULL)
+        return(-1);
+    memcpy(val, base, prefixLen);
+    if ((URI[0] != '/') && (prefixLen == pathStart))
+        val[prefixLen++] = '/';
+    memcpy(val + prefixLen, URI, refLen + 1);
+    if (URI[0] != '/')
+        xmlNormalizeURIPath((char *) val + pathStart);
+
+    *valPtr = val;
+    return(0);
+}
+
 /**
  * Computes he final URI of the reference done by checking that
  * the given URI is valid, and building the final URI using the
@@ -1989,6 +2148,12 @@ xmlBuildURISafe(const xmlChar *URI, const xmlChar *base, xmlChar **valPtr) {
         return(0);
     }
 
+    if (URI[0] != 0) {
+        ret = xmlBuildURIFast(URI, base, valPtr);
+        if (ret <= 0)
+            return(ret);
+    }
+
     /*
      * 1) The URI reference is parsed into the potential four components and
      *    fragment identifier, as described in Section 4.3.
@@ -24,10 +24,12 @@
 #include <libxml/xmlsave.h>
 
 #include "private/error.h"
+#include "private/hash.h"
 #include "private/memory.h"
 #include "private/parser.h"
 #include "private/regexp.h"
 #include "private/save.h"
+#include "private/trace.h"
 #include "private/tree.h"
 
 static xmlElementPtr
@@ -209,6 +211,7 @@ typedef struct _xmlValidState {
     xmlElementPtr	 elemDecl;	/* pointer to the content model */
     xmlNodePtr           node;		/* pointer to the current node */
     xmlRegExecCtxtPtr    exec;		/* regexp runtime */
+    int                  state;		/* name table state, -1 on error */
 } _xmlValidState;
 
 
@@ -235,10 +238,14 @@ vstateVPush(xmlValidCtxtPtr ctxt, xmlElementPtr elemDecl, xmlNodePtr node) {
     ctxt->vstate = &ctxt->vstateTab[ctxt->vstateNr];
     ctxt->vstateTab[ctxt->vstateNr].elemDecl = elemDecl;
     ctxt->vstateTab[ctxt->vstateNr].node = node;
+    ctxt->vstateTab[ctxt->vstateNr].exec = NULL;
+    ctxt->vstateTab[ctxt->vstateNr].state = 0;
     if ((elemDecl != NULL) && (elemDecl->etype == XML_ELEMENT_TYPE_ELEMENT)) {
 	if (elemDecl->contModel == NULL)
 	    xmlValidBuildContentModel(ctxt, elemDecl);
-	if (elemDecl->contModel != NULL) {
+	if (xmlRegexpHasNameTable(elemDecl->contModel)) {
+	    /* Walk the name table, no runtime needed */
+	} else if (elemDecl->contModel != NULL) {
 	    ctxt->vstateTab[ctxt->vstateNr].exec =
 		xmlRegNewExecCtxt(elemDecl->contModel, NULL, NULL);
             if (ctxt->vstateTab[ctxt->vstateNr].exec == NULL) {
@@ -246,7 +253,6 @@ vstateVPush(xmlValidCtxtPtr ctxt, xmlElementPtr elemDecl, xmlNodePtr node) {
                 return(-1);
             }
 	} else {
-	    ctxt->vstateTab[ctxt->vstateNr].exec = NULL;
 	    xmlErrValidNode(ctxt, (xmlNodePtr) elemDecl,
 	                    XML_ERR_INTERNAL_ERROR,
 			    "Failed to build content model regexp for %s\n",
@@ -276,6 +282,27 @@ vstateVPop(xmlValidCtxtPtr ctxt) {
     return(ctxt->vstateNr);
 }
 
+/*
+ * Push a child name, or NULL at the end of the content. Deterministic
+ * content models are matched by walking their name table, other ones
+ * through the regexp runtime. Returns the same values as
+ * xmlRegExecPushString.
+ */
+static int
+xmlValidPushName(xmlRegExecCtxtPtr exec, xmlRegexpPtr contModel, int *state,
+                 const xmlChar *name) {
+    if (exec != NULL)
+        return(xmlRegExecPushString(exec, name, NULL));
+    if (*state < 0)
+        return(XML_REGEXP_NOT_FOUND);
+    if (name != NULL) {
+        *state = xmlRegexpNameStep(contModel, *state, name);
+        if (*state < 0)
+            return(XML_REGEXP_NOT_FOUND);
+    }
+    return(xmlRegexpIsFinalState(contModel, *state));
+}
+
 #else /* not LIBXML_REGEXP_ENABLED */
 /*
  * If regexp are not enabled, it uses a home made algorithm less
@@ -637,6 +664,13 @@ xmlValidBuildContentModel(xmlValidCtxt *ctxt, xmlElement *elem) {
         ctxt->valid = 0;
 	goto done;
     }
+    /*
+     * Resolve the child names once so that validation doesn't
+     * have to compare strings. The runtime is used as fallback.
+     */
+    if (xmlRegexpBuildNameTable(elem->contModel,
+                                elem->doc ? elem->doc->dict : NULL) < 0)
+        xmlVErrMemory(ctxt);
 
     ret = 1;
 
@@ -1147,6 +1181,7 @@ xmlAddElementDecl(xmlValidCtxt *ctxt,
         table = xmlHashCreateDict(0, dict);
         if (table == NULL)
             goto mem_error;
+        xmlHashIndexInterned(table);
 	dtd->elements = (void *) table;
     }
 
@@ -1155,7 +1190,8 @@ xmlAddElementDecl(xmlValidCtxt *ctxt,
      * internal subset.
      */
     if ((dtd->doc != NULL) && (dtd->doc->intSubset != NULL)) {
-	ret = xmlHashLookup2(dtd->doc->intSubset->elements, localName, prefix);
+	ret = xmlHashLookupInterned2(dtd->doc->intSubset->elements,
+                                     localName, prefix);
 	if ((ret != NULL) && (ret->etype == XML_ELEMENT_TYPE_UNDEFINED)) {
 	    oldAttributes = ret->attributes;
 	    ret->attributes = NULL;
@@ -1169,7 +1205,7 @@ xmlAddElementDecl(xmlValidCtxt *ctxt,
      * The element may already be present if one of its attribute
      * was registered first
      */
-    ret = xmlHashLookup2(table, localName, prefix);
+    ret = xmlHashLookupInterned2(table, localName, prefix);
     if (ret != NULL) {
 	if (ret->etype != XML_ELEMENT_TYPE_UNDEFINED) {
 #ifdef LIBXML_VALID_ENABLED
@@ -1611,7 +1647,8 @@ xmlAddAttributeDecl(xmlValidCtxt *ctxt,
     if ((dtd->doc != NULL) && (dtd->doc->extSubset == dtd) &&
 	(dtd->doc->intSubset != NULL) &&
 	(dtd->doc->intSubset->attributes != NULL)) {
-        ret = xmlHashLookup3(dtd->doc->intSubset->attributes, name, ns, elem);
+        ret = xmlHashLookupInterned3(dtd->doc->intSubset->attributes,
+                                     name, ns, elem);
 	if (ret != NULL) {
 	    xmlFreeEnumeration(tree);
 	    return(NULL);
@@ -1624,6 +1661,7 @@ xmlAddAttributeDecl(xmlValidCtxt *ctxt,
     table = (xmlAttributeTablePtr) dtd->attributes;
     if (table == NULL) {
         table = xmlHashCreateDict(0, dict);
+        xmlHashIndexInterned(table);
 	dtd->attributes = (void *) table;
     }
     if (table == NULL)
@@ -2157,7 +2195,7 @@ xmlFreeID(xmlIDPtr id) {
         dict = id->doc->dict;
 
     if (id->value != NULL)
-	xmlFree(id->value);
+	DICT_FREE(id->value)
     if (id->name != NULL)
 	DICT_FREE(id->name)
     if (id->attr != NULL) {
@@ -2197,17 +2235,14 @@ xmlAddIDInternal(xmlAttrPtr attr, const xmlChar *value, xmlIDPtr *idPtr) {
         return(0);
 
     /*
-     * Create the ID table if needed.
+     * Create the ID table if needed. Keys are shared with the
+     * document's dictionary.
      */
     table = (xmlIDTablePtr) doc->ids;
     if (table == NULL)  {
-        doc->ids = table = xmlHashCreate(0);
+        doc->ids = table = xmlHashCreateDict(0, doc->dict);
         if (table == NULL)
             return(-1);
-    } else {
-        id = xmlHashLookup(table, value);
-        if (id != NULL)
-            return(0);
     }
 
     id = (xmlIDPtr) xmlMalloc(sizeof(xmlID));
@@ -2219,21 +2254,27 @@ xmlAddIDInternal(xmlAttrPtr attr, const xmlChar *value, xmlIDPtr *idPtr) {
      * fill the structure.
      */
     id->doc = doc;
-    id->value = xmlStrdup(value);
+    if (doc->dict != NULL)
+        id->value = (xmlChar *) xmlDictLookup(doc->dict, value, -1);
+    else
+        id->value = xmlStrdup(value);
     if (id->value == NULL) {
         xmlFreeID(id);
         return(-1);
     }
 
-    if (attr->id != NULL)
-        xmlRemoveID(doc, attr);
-
-    if (xmlHashAddEntry(table, value, id) < 0) {
+    /*
+     * A single insertion also checks whether the ID already exists.
+     */
+    ret = xmlHashAdd(table, id->value, id);
+    if (ret <= 0) {
 	xmlFreeID(id);
-	return(-1);
+	return(ret);
     }
 
-    ret = 1;
+    if (attr->id != NULL)
+        xmlRemoveID(doc, attr);
+
     if (idPtr != NULL)
         *idPtr = id;
 
@@ -2407,6 +2448,57 @@ xmlRemoveID(xmlDoc *doc, xmlAttr *attr) {
     return(0);
 }
 
+/**
+ * Add the ID attributes which were only marked while parsing with
+ * lazy IDs to the ID table. The document is walked in document
+ * order, so the first of several attributes with the same ID wins
+ * like with eager collection.
+ *
+ * @param doc  the document
+ * @returns 0 on success or -1 if a memory allocation failed. The
+ * remaining IDs are collected on the next lookup in this case.
+ */
+int
+xmlCollectLazyIds(xmlDocPtr doc) {
+    xmlNodePtr cur;
+    xmlAttrPtr attr;
+
+    doc->properties &= ~XML_DOC_LAZY_IDS;
+
+    cur = doc->children;
+    while (cur != NULL) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            for (attr = cur->properties; attr != NULL; attr = attr->next) {
+                if ((attr->atype == XML_ATTRIBUTE_ID) &&
+                    (attr->id == NULL) &&
+                    (attr->children != NULL) &&
+                    (attr->children->type == XML_TEXT_NODE) &&
+                    (attr->children->next == NULL) &&
+                    (xmlAddIDInternal(attr, attr->children->content,
+                                      NULL) < 0)) {
+                    /* Retry on the next lookup */
+                    doc->properties |= XML_DOC_LAZY_IDS;
+                    return(-1);
+                }
+            }
+
+            if (cur->children != NULL) {
+                cur = cur->children;
+                continue;
+            }
+        }
+
+        while (cur->next == NULL) {
+            cur = cur->parent;
+            if ((cur == NULL) || (cur == (xmlNodePtr) doc))
+                return(0);
+        }
+        cur = cur->next;
+    }
+
+    return(0);
+}
+
 /**
  * Search the document's ID table for the attribute with the
  * given ID.
@@ -2428,6 +2520,9 @@ xmlGetID(xmlDoc *doc, const xmlChar *ID) {
 	return(NULL);
     }
 
+    if (doc->properties & XML_DOC_LAZY_IDS)
+        xmlCollectLazyIds(doc);
+
     table = (xmlIDTablePtr) doc->ids;
     if (table == NULL)
         return(NULL);
@@ -2450,68 +2545,51 @@ xmlGetID(xmlDoc *doc, const xmlChar *ID) {
  *				Refs					*
  *									*
  ************************************************************************/
-typedef struct xmlRemoveMemo_t
-{
-	xmlListPtr l;
-	xmlAttrPtr ap;
-} xmlRemoveMemo;
-
-typedef xmlRemoveMemo *xmlRemoveMemoPtr;
-
-typedef struct xmlValidateMemo_t
-{
-    xmlValidCtxtPtr ctxt;
-    const xmlChar *name;
-} xmlValidateMemo;
 
-typedef xmlValidateMemo *xmlValidateMemoPtr;
+/*
+ * References to an ID value are stored in a vector which also owns
+ * the value string shared by the references. A list for the
+ * deprecated xmlGetRefs API is only created on demand.
+ */
+typedef struct {
+    xmlChar *value;
+    xmlRefPtr *refs;
+    int nbRefs;
+    int maxRefs;
+    xmlListPtr list;
+} xmlRefVec;
 
 /**
  * Deallocate the memory used by a ref definition.
  *
- * @param lk  A list link
+ * @param ref  a reference
  */
 static void
-xmlFreeRef(xmlLinkPtr lk) {
-    xmlRefPtr ref = (xmlRefPtr)xmlLinkGetData(lk);
-    if (ref == NULL) return;
-    if (ref->value != NULL)
-        xmlFree((xmlChar *)ref->value);
+xmlFreeRef(xmlRefPtr ref) {
     if (ref->name != NULL)
         xmlFree((xmlChar *)ref->name);
     xmlFree(ref);
 }
 
 /**
- * Deallocate the memory used by a list of references.
+ * Deallocate the memory used by a vector of references.
  *
- * @param payload  A list of references.
+ * @param payload  A vector of references.
  * @param name  unused
  */
 static void
 xmlFreeRefTableEntry(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
-    xmlListPtr list_ref = (xmlListPtr) payload;
-    if (list_ref == NULL) return;
-    xmlListDelete(list_ref);
-}
-
-/**
- * @param data  Contents of current link
- * @param user  Value supplied by the user
- * @returns 0 to abort the walk or 1 to continue.
- */
-static int
-xmlWalkRemoveRef(const void *data, void *user)
-{
-    xmlAttrPtr attr0 = ((xmlRefPtr)data)->attr;
-    xmlAttrPtr attr1 = ((xmlRemoveMemoPtr)user)->ap;
-    xmlListPtr ref_list = ((xmlRemoveMemoPtr)user)->l;
+    xmlRefVec *vec = payload;
+    int i;
 
-    if (attr0 == attr1) { /* Matched: remove and terminate walk */
-        xmlListRemoveFirst(ref_list, (void *)data);
-        return 0;
-    }
-    return 1;
+    if (vec == NULL) return;
+    for (i = 0; i < vec->nbRefs; i++)
+        xmlFreeRef(vec->refs[i]);
+    if (vec->list != NULL)
+        xmlListDelete(vec->list);
+    xmlFree(vec->refs);
+    xmlFree(vec->value);
+    xmlFree(vec);
 }
 
 /**
@@ -2528,6 +2606,28 @@ xmlDummyCompare(const void *data0 ATTRIBUTE_UNUSED,
     return (0);
 }
 
+/**
+ * Refill the list returned by xmlGetRefs after a change.
+ *
+ * @param vec  a vector of references
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+static int
+xmlRefVecSyncList(xmlRefVec *vec) {
+    int i;
+
+    if (vec->list == NULL)
+        return(0);
+
+    xmlListClear(vec->list);
+    for (i = 0; i < vec->nbRefs; i++) {
+        if (xmlListAppend(vec->list, vec->refs[i]) != 0)
+            return(-1);
+    }
+
+    return(0);
+}
+
 /**
  * Register a new ref declaration.
  *
@@ -2545,7 +2645,7 @@ xmlAddRef(xmlValidCtxt *ctxt, xmlDoc *doc, const xmlChar *value,
     xmlAttr *attr) {
     xmlRefPtr ret = NULL;
     xmlRefTablePtr table;
-    xmlListPtr ref_list;
+    xmlRefVec *vec;
 
     if (doc == NULL) {
         return(NULL);
@@ -2575,9 +2675,6 @@ xmlAddRef(xmlValidCtxt *ctxt, xmlDoc *doc, const xmlChar *value,
     /*
      * fill the structure.
      */
-    ret->value = xmlStrdup(value);
-    if (ret->value == NULL)
-        goto failed;
     if (xmlIsStreaming(ctxt)) {
 	/*
 	 * Operating in streaming mode, attr is gonna disappear
@@ -2592,39 +2689,43 @@ xmlAddRef(xmlValidCtxt *ctxt, xmlDoc *doc, const xmlChar *value,
     }
     ret->lineno = xmlGetLineNo(attr->parent);
 
-    /* To add a reference :-
-     * References are maintained as a list of references,
-     * Lookup the entry, if no entry create new nodelist
-     * Add the owning node to the NodeList
-     * Return the ref
-     */
-
-    ref_list = xmlHashLookup(table, value);
-    if (ref_list == NULL) {
-        int res;
-
-        ref_list = xmlListCreate(xmlFreeRef, xmlDummyCompare);
-        if (ref_list == NULL)
-	    goto failed;
-        res = xmlHashAdd(table, value, ref_list);
-        if (res <= 0) {
-            xmlListDelete(ref_list);
+    vec = xmlHashLookup(table, value);
+    if (vec == NULL) {
+        vec = xmlMalloc(sizeof(*vec));
+        if (vec == NULL)
+            goto failed;
+        memset(vec, 0, sizeof(*vec));
+        vec->value = xmlStrdup(value);
+        if ((vec->value == NULL) ||
+            (xmlHashAdd(table, value, vec) <= 0)) {
+            xmlFreeRefTableEntry(vec, NULL);
 	    goto failed;
         }
     }
-    if (xmlListAppend(ref_list, ret) != 0)
-        goto failed;
+    if (vec->nbRefs >= vec->maxRefs) {
+        xmlRefPtr *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(vec->maxRefs, sizeof(tmp[0]),
+                                  4, XML_MAX_ITEMS);
+        if (newSize < 0)
+            goto failed;
+        tmp = xmlRealloc(vec->refs, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto failed;
+        vec->refs = tmp;
+        vec->maxRefs = newSize;
+    }
+    ret->value = vec->value;
+    vec->refs[vec->nbRefs++] = ret;
+    if ((vec->list != NULL) && (xmlListAppend(vec->list, ret) != 0))
+        xmlVErrMemory(ctxt);
     return(ret);
 
 failed:
     xmlVErrMemory(ctxt);
-    if (ret != NULL) {
-        if (ret->value != NULL)
-	    xmlFree((char *)ret->value);
-        if (ret->name != NULL)
-	    xmlFree((char *)ret->name);
-        xmlFree(ret);
-    }
+    if (ret != NULL)
+        xmlFreeRef(ret);
     return(NULL);
 }
 
@@ -2700,10 +2801,10 @@ xmlIsRef(xmlDoc *doc, xmlNode *elem, xmlAttr *attr) {
  */
 int
 xmlRemoveRef(xmlDoc *doc, xmlAttr *attr) {
-    xmlListPtr ref_list;
+    xmlRefVec *vec;
     xmlRefTablePtr table;
     xmlChar *ID;
-    xmlRemoveMemo target;
+    int i;
 
     if (doc == NULL) return(-1);
     if (attr == NULL) return(-1);
@@ -2716,30 +2817,26 @@ xmlRemoveRef(xmlDoc *doc, xmlAttr *attr) {
     if (ID == NULL)
         return(-1);
 
-    ref_list = xmlHashLookup(table, ID);
-    if(ref_list == NULL) {
+    vec = xmlHashLookup(table, ID);
+    if (vec == NULL) {
         xmlFree(ID);
         return (-1);
     }
 
-    /* At this point, ref_list refers to a list of references which
-     * have the same key as the supplied attr. Our list of references
-     * is ordered by reference address and we don't have that information
-     * here to use when removing. We'll have to walk the list and
-     * check for a matching attribute, when we find one stop the walk
-     * and remove the entry.
-     * The list is ordered by reference, so that means we don't have the
-     * key. Passing the list and the reference to the walker means we
-     * will have enough data to be able to remove the entry.
-     */
-    target.l = ref_list;
-    target.ap = attr;
-
-    /* Remove the supplied attr from our list */
-    xmlListWalk(ref_list, xmlWalkRemoveRef, &target);
+    /* Remove the first reference from the supplied attr */
+    for (i = 0; i < vec->nbRefs; i++) {
+        if (vec->refs[i]->attr == attr) {
+            xmlFreeRef(vec->refs[i]);
+            vec->nbRefs -= 1;
+            memmove(&vec->refs[i], &vec->refs[i + 1],
+                    (vec->nbRefs - i) * sizeof(vec->refs[0]));
+            xmlRefVecSyncList(vec);
+            break;
+        }
+    }
 
-    /*If the list is empty then remove the list entry in the hash */
-    if (xmlListEmpty(ref_list))
+    /*If the vector is empty then remove the entry in the hash */
+    if (vec->nbRefs == 0)
         xmlHashRemoveEntry(table, ID, xmlFreeRefTableEntry);
     xmlFree(ID);
     return(0);
@@ -2758,6 +2855,7 @@ xmlRemoveRef(xmlDoc *doc, xmlAttr *attr) {
 xmlList *
 xmlGetRefs(xmlDoc *doc, const xmlChar *ID) {
     xmlRefTablePtr table;
+    xmlRefVec *vec;
 
     if (doc == NULL) {
         return(NULL);
@@ -2771,7 +2869,22 @@ xmlGetRefs(xmlDoc *doc, const xmlChar *ID) {
     if (table == NULL)
         return(NULL);
 
-    return (xmlHashLookup(table, ID));
+    vec = xmlHashLookup(table, ID);
+    if (vec == NULL)
+        return(NULL);
+
+    if (vec->list == NULL) {
+        vec->list = xmlListCreate(NULL, xmlDummyCompare);
+        if (vec->list == NULL)
+            return(NULL);
+        if (xmlRefVecSyncList(vec) < 0) {
+            xmlListDelete(vec->list);
+            vec->list = NULL;
+            return(NULL);
+        }
+    }
+
+    return(vec->list);
 }
 
 /************************************************************************
@@ -2808,7 +2921,7 @@ xmlGetDtdElementDesc(xmlDtd *dtd, const xmlChar *name) {
     localname = xmlSplitQName4(name, &prefix);
     if (localname == NULL)
         return(NULL);
-    cur = xmlHashLookup2(table, localname, prefix);
+    cur = xmlHashLookupInterned2(table, localname, prefix);
     if (prefix != NULL)
         xmlFree(prefix);
     return(cur);
@@ -2844,13 +2957,14 @@ xmlGetDtdElementDesc2(xmlValidCtxtPtr ctxt, xmlDtdPtr dtd, const xmlChar *name)
 	dtd->elements = xmlHashCreateDict(0, dict);
 	if (dtd->elements == NULL)
             goto mem_error;
+        xmlHashIndexInterned(dtd->elements);
     }
     table = (xmlElementTablePtr) dtd->elements;
 
     localName = xmlSplitQName4(name, &prefix);
     if (localName == NULL)
         goto mem_error;
-    cur = xmlHashLookup2(table, localName, prefix);
+    cur = xmlHashLookupInterned2(table, localName, prefix);
     if (cur == NULL) {
 	cur = (xmlElementPtr) xmlMalloc(sizeof(xmlElement));
 	if (cur == NULL)
@@ -2902,7 +3016,7 @@ xmlGetDtdQElementDesc(xmlDtd *dtd, const xmlChar *name,
     if (dtd->elements == NULL) return(NULL);
     table = (xmlElementTablePtr) dtd->elements;
 
-    return(xmlHashLookup2(table, name, prefix));
+    return(xmlHashLookupInterned2(table, name, prefix));
 }
 
 /**
@@ -2933,7 +3047,7 @@ xmlGetDtdAttrDesc(xmlDtd *dtd, const xmlChar *elem, const xmlChar *name) {
     localname = xmlSplitQName4(name, &prefix);
     if (localname == NULL)
         return(NULL);
-    cur = xmlHashLookup3(table, localname, prefix, elem);
+    cur = xmlHashLookupInterned3(table, localname, prefix, elem);
     if (prefix != NULL)
         xmlFree(prefix);
     return(cur);
@@ -2959,7 +3073,7 @@ xmlGetDtdQAttrDesc(xmlDtd *dtd, const xmlChar *elem, const xmlChar *name,
     if (dtd->attributes == NULL) return(NULL);
     table = (xmlAttributeTablePtr) dtd->attributes;
 
-    return(xmlHashLookup3(table, name, prefix, elem));
+    return(xmlHashLookupInterned3(table, name, prefix, elem));
 }
 
 /**
@@ -3505,11 +3619,11 @@ xmlValidCtxtNormalizeAttributeValue(xmlValidCtxt *ctxt, xmlDoc *doc,
 	if (elemname == NULL)
 	    goto mem_error;
         if (doc->intSubset != NULL)
-            attrDecl = xmlHashLookup3(doc->intSubset->attributes, localName,
-                                      prefix, elemname);
+            attrDecl = xmlHashLookupInterned3(doc->intSubset->attributes,
+                                              localName, prefix, elemname);
 	if ((attrDecl == NULL) && (doc->extSubset != NULL)) {
-	    attrDecl = xmlHashLookup3(doc->extSubset->attributes, localName,
-                                      prefix, elemname);
+	    attrDecl = xmlHashLookupInterned3(doc->extSubset->attributes,
+                                              localName, prefix, elemname);
 	    if (attrDecl != NULL)
 		extsubset = 1;
 	}
@@ -3517,11 +3631,11 @@ xmlValidCtxtNormalizeAttributeValue(xmlValidCtxt *ctxt, xmlDoc *doc,
 	    xmlFree(elemname);
     }
     if ((attrDecl == NULL) && (doc->intSubset != NULL))
-	attrDecl = xmlHashLookup3(doc->intSubset->attributes, localName,
-                                  prefix, elem->name);
+	attrDecl = xmlHashLookupInterned3(doc->intSubset->attributes,
+                                          localName, prefix, elem->name);
     if ((attrDecl == NULL) && (doc->extSubset != NULL)) {
-	attrDecl = xmlHashLookup3(doc->extSubset->attributes, localName,
-                                  prefix, elem->name);
+	attrDecl = xmlHashLookupInterned3(doc->extSubset->attributes,
+                                          localName, prefix, elem->name);
 	if (attrDecl != NULL)
 	    extsubset = 1;
     }
@@ -3682,8 +3796,8 @@ xmlValidateAttributeDecl(xmlValidCtxt *ctxt, xmlDoc *doc,
 
 	/* the trick is that we parse DtD as their own internal subset */
         if (doc->intSubset != NULL)
-            elem = xmlHashLookup2(doc->intSubset->elements,
-                                  elemLocalName, elemPrefix);
+            elem = xmlHashLookupInterned2(doc->intSubset->elements,
+                                          elemLocalName, elemPrefix);
 	if (elem != NULL) {
 	    nbId = xmlScanIDAttributeDecl(ctxt, elem, 0);
 	} else {
@@ -3708,8 +3822,8 @@ xmlValidateAttributeDecl(xmlValidCtxt *ctxt, xmlDoc *doc,
             ret = 0;
 	} else if (doc->extSubset != NULL) {
 	    int extId = 0;
-	    elem = xmlHashLookup2(doc->extSubset->elements,
-                                  elemLocalName, elemPrefix);
+	    elem = xmlHashLookupInterned2(doc->extSubset->elements,
+                                          elemLocalName, elemPrefix);
 	    if (elem != NULL) {
 		extId = xmlScanIDAttributeDecl(ctxt, elem, 0);
 	    }
@@ -3835,7 +3949,8 @@ xmlValidateElementDecl(xmlValidCtxt *ctxt, xmlDoc *doc,
 
     /* VC: Unique Element Type Declaration */
     if (doc->intSubset != NULL) {
-        tst = xmlHashLookup2(doc->intSubset->elements, localName, prefix);
+        tst = xmlHashLookupInterned2(doc->intSubset->elements,
+                                     localName, prefix);
 
         if ((tst != NULL ) && (tst != elem) &&
             ((tst->prefix == elem->prefix) ||
@@ -3848,7 +3963,8 @@ xmlValidateElementDecl(xmlValidCtxt *ctxt, xmlDoc *doc,
         }
     }
     if (doc->extSubset != NULL) {
-        tst = xmlHashLookup2(doc->extSubset->elements, localName, prefix);
+        tst = xmlHashLookupInterned2(doc->extSubset->elements,
+                                     localName, prefix);
 
         if ((tst != NULL ) && (tst != elem) &&
             ((tst->prefix == elem->prefix) ||
@@ -4726,7 +4842,8 @@ xmlValidateElementContent(xmlValidCtxtPtr ctxt, xmlNodePtr child,
     if (elemDecl->contModel == NULL) {
 	return(-1);
     } else {
-	xmlRegExecCtxtPtr exec;
+	xmlRegExecCtxtPtr exec = NULL;
+        int state = 0;
 
 	if (!xmlRegexpIsDeterminist(elemDecl->contModel)) {
 	    return(-1);
@@ -4734,10 +4851,12 @@ xmlValidateElementContent(xmlValidCtxtPtr ctxt, xmlNodePtr child,
 	ctxt->nodeMax = 0;
 	ctxt->nodeNr = 0;
 	ctxt->nodeTab = NULL;
-	exec = xmlRegNewExecCtxt(elemDecl->contModel, NULL, NULL);
-	if (exec == NULL) {
-            xmlVErrMemory(ctxt);
-            return(-1);
+        if (!xmlRegexpHasNameTable(elemDecl->contModel)) {
+            exec = xmlRegNewExecCtxt(elemDecl->contModel, NULL, NULL);
+            if (exec == NULL) {
+                xmlVErrMemory(ctxt);
+                return(-1);
+            }
         }
         cur = child;
         while (cur != NULL) {
@@ -4778,11 +4897,13 @@ xmlValidateElementContent(xmlValidCtxtPtr ctxt, xmlNodePtr child,
                             ret = -1;
                             goto fail;
                         }
-                        ret = xmlRegExecPushString(exec, fullname, NULL);
+                        ret = xmlValidPushName(exec, elemDecl->contModel,
+                                               &state, fullname);
                         if ((fullname != fn) && (fullname != cur->name))
                             xmlFree(fullname);
                     } else {
-                        ret = xmlRegExecPushString(exec, cur->name, NULL);
+                        ret = xmlValidPushName(exec, elemDecl->contModel,
+                                               &state, cur->name);
                     }
                     break;
                 default:
@@ -4801,7 +4922,7 @@ xmlValidateElementContent(xmlValidCtxtPtr ctxt, xmlNodePtr child,
                 cur = cur->next;
             }
         }
-        ret = xmlRegExecPushString(exec, NULL, NULL);
+        ret = xmlValidPushName(exec, elemDecl->contModel, &state, NULL);
         if (ret == XML_REGEXP_OUT_OF_MEMORY)
             xmlVErrMemory(ctxt);
 fail:
@@ -5267,8 +5388,10 @@ xmlValidatePushElement(xmlValidCtxt *ctxt, xmlDoc *doc,
 		     *     - element types with element content, if white space
 		     *       occurs directly within any instance of those types.
 		     */
-		    if (state->exec != NULL) {
-			ret = xmlRegExecPushString(state->exec, qname, NULL);
+		    if ((state->exec != NULL) ||
+                        (xmlRegexpHasNameTable(elemDecl->contModel))) {
+			ret = xmlValidPushName(state->exec, elemDecl->contModel,
+                                               &state->state, qname);
                         if (ret == XML_REGEXP_OUT_OF_MEMORY) {
                             xmlVErrMemory(ctxt);
                             return(0);
@@ -5394,8 +5517,10 @@ xmlValidatePopElement(xmlValidCtxt *ctxt, xmlDoc *doc ATTRIBUTE_UNUSED,
 	    elemDecl = state->elemDecl;
 
 	    if (elemDecl->etype == XML_ELEMENT_TYPE_ELEMENT) {
-		if (state->exec != NULL) {
-		    ret = xmlRegExecPushString(state->exec, NULL, NULL);
+		if ((state->exec != NULL) ||
+                    (xmlRegexpHasNameTable(elemDecl->contModel))) {
+		    ret = xmlValidPushName(state->exec, elemDecl->contModel,
+                                           &state->state, NULL);
 		    if (ret <= 0) {
                         if (ret == XML_REGEXP_OUT_OF_MEMORY)
                             xmlVErrMemory(ctxt);
@@ -5941,36 +6066,21 @@ xmlValidateRef(xmlRefPtr ref, xmlValidCtxtPtr ctxt,
 }
 
 /**
- * @param data  Contents of current link
- * @param user  Value supplied by the user
- * @returns 0 to abort the walk or 1 to continue.
- */
-static int
-xmlWalkValidateList(const void *data, void *user)
-{
-	xmlValidateMemoPtr memo = (xmlValidateMemoPtr)user;
-	xmlValidateRef((xmlRefPtr)data, memo->ctxt, memo->name);
-	return 1;
-}
-
-/**
- * @param payload  list of references
+ * @param payload  vector of references
  * @param data  validation context
  * @param name  name of ID we are searching for
  */
 static void
 xmlValidateCheckRefCallback(void *payload, void *data, const xmlChar *name) {
-    xmlListPtr ref_list = (xmlListPtr) payload;
+    xmlRefVec *vec = payload;
     xmlValidCtxtPtr ctxt = (xmlValidCtxtPtr) data;
-    xmlValidateMemo memo;
+    int i;
 
-    if (ref_list == NULL)
+    if (vec == NULL)
 	return;
-    memo.ctxt = ctxt;
-    memo.name = name;
-
-    xmlListWalk(ref_list, xmlWalkValidateList, &memo);
 
+    for (i = 0; i < vec->nbRefs; i++)
+        xmlValidateRef(vec->refs[i], ctxt, name);
 }
 
 /**
@@ -6162,15 +6272,15 @@ xmlValidateAttributeCallback(void *payload, void *data,
         }
 
 	if ((doc != NULL) && (doc->intSubset != NULL))
-	    elem = xmlHashLookup2(doc->intSubset->elements,
-                                  elemLocalName, elemPrefix);
+	    elem = xmlHashLookupInterned2(doc->intSubset->elements,
+                                          elemLocalName, elemPrefix);
 	if ((elem == NULL) && (doc != NULL) && (doc->extSubset != NULL))
-	    elem = xmlHashLookup2(doc->extSubset->elements,
-                                  elemLocalName, elemPrefix);
+	    elem = xmlHashLookupInterned2(doc->extSubset->elements,
+                                          elemLocalName, elemPrefix);
 	if ((elem == NULL) && (cur->parent != NULL) &&
 	    (cur->parent->type == XML_DTD_NODE))
-	    elem = xmlHashLookup2(((xmlDtdPtr) cur->parent)->elements,
-                                  elemLocalName, elemPrefix);
+	    elem = xmlHashLookupInterned2(((xmlDtdPtr) cur->parent)->elements,
+                                          elemLocalName, elemPrefix);
 
         xmlFree(elemPrefix);
 
@@ -6261,6 +6371,9 @@ xmlValidateDocumentInternal(xmlParserCtxtPtr ctxt, xmlValidCtxtPtr vctxt,
 	return(0);
     }
 
+    if (doc->properties & XML_DOC_LAZY_IDS)
+        xmlCollectLazyIds(doc);
+
     if ((doc->intSubset != NULL) && ((doc->intSubset->SystemID != NULL) ||
 	(doc->intSubset->ExternalID != NULL)) && (doc->extSubset == NULL)) {
 	xmlChar *sysID = NULL;
@@ -6347,7 +6460,14 @@ xmlValidateDocumentInternal(xmlParserCtxtPtr ctxt, xmlValidCtxtPtr vctxt,
  */
 int
 xmlValidateDocument(xmlValidCtxt *vctxt, xmlDoc *doc) {
-    return(xmlValidateDocumentInternal(NULL, vctxt, doc));
+    double start;
+    int ret;
+
+    XML_TRACE_BEGIN(valid, XML_TRACE_VALID_START, "dtd", start);
+    ret = xmlValidateDocumentInternal(NULL, vctxt, doc);
+    XML_TRACE_END(valid, XML_TRACE_VALID_END, "dtd", -1L, start);
+
+    return(ret);
 }
 
 /**
@@ -6366,12 +6486,19 @@ xmlValidateDocument(xmlValidCtxt *vctxt, xmlDoc *doc) {
  */
 int
 xmlCtxtValidateDocument(xmlParserCtxt *ctxt, xmlDoc *doc) {
+    double start;
+    int ret;
+
     if ((ctxt == NULL) || (ctxt->html))
         return(0);
 
     xmlCtxtReset(ctxt);
 
-    return(xmlValidateDocumentInternal(ctxt, &ctxt->vctxt, doc));
+    XML_TRACE_BEGIN(valid, XML_TRACE_VALID_START, "dtd", start);
+    ret = xmlValidateDocumentInternal(ctxt, &ctxt->vctxt, doc);
+    XML_TRACE_END(valid, XML_TRACE_VALID_END, "dtd", -1L, start);
+
+    return(ret);
 }
 
 /************************************************************************
@@ -30,9 +30,14 @@
 #include "private/error.h"
 #include "private/memory.h"
 #include "private/parser.h"
+#include "private/threads.h"
 #include "private/tree.h"
 #include "private/xinclude.h"
 
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #define XML_XINCLUDE_PARALLEL
+#endif
+
 #define XINCLUDE_MAX_DEPTH 40
 
 /************************************************************************
@@ -66,6 +71,8 @@ struct _xmlXIncludeDoc {
     xmlDocPtr             doc; /* the parsed document */
     xmlChar              *url; /* the URL */
     int             expanding; /* flag to detect inclusion loops */
+    int               pending; /* parsed ahead of time, not expanded yet */
+    int            parseFlags; /* the flags used for a pending document */
 };
 
 typedef struct _xmlXIncludeTxt xmlXIncludeTxt;
@@ -105,6 +112,7 @@ struct _xmlXIncludeCtxt {
 
 #ifdef LIBXML_XPTR_ENABLED
     xmlXPathContextPtr xpctxt;
+    xmlHashTablePtr xptrCache; /* compiled XPointers by expression */
 #endif
 
     xmlStructuredErrorFunc errorHandler;
@@ -112,6 +120,34 @@ struct _xmlXIncludeCtxt {
 
     xmlResourceLoader resourceLoader;
     void *resourceCtxt;
+
+    int       parallelThreads; /* threads loading documents ahead */
+    xmlXIncludeCache *sharedCache; /* cache shared between contexts */
+};
+
+/*
+ * A cached document or text resource, keyed by URL and variant
+ */
+typedef struct _xmlXIncludeCacheEntry xmlXIncludeCacheEntry;
+struct _xmlXIncludeCacheEntry {
+    xmlXIncludeCacheEntry *prev;
+    xmlXIncludeCacheEntry *next;
+    xmlChar *url;
+    xmlChar *variant;           /* parser flags or text encoding */
+    xmlDocSnapshotPtr snap;     /* the parsed document */
+    xmlChar *text;              /* or the text */
+    size_t size;
+    int refs;                   /* copies in progress */
+    int removed;                /* evicted while copies were made */
+};
+
+struct _xmlXIncludeCache {
+    xmlMutex mutex;
+    xmlHashTablePtr hash;
+    xmlXIncludeCacheEntry *first; /* most recently used */
+    xmlXIncludeCacheEntry *last;
+    size_t used;
+    size_t max;
 };
 
 static xmlXIncludeRefPtr
@@ -272,6 +308,13 @@ xmlXIncludeNewContext(xmlDoc *doc) {
     return(ret);
 }
 
+#ifdef LIBXML_XPTR_ENABLED
+static void
+xmlXIncludeFreeXPointer(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlXPtrFreeCompExpr(payload);
+}
+#endif
+
 /**
  * Free an XInclude context
  *
@@ -306,10 +349,400 @@ xmlXIncludeFreeContext(xmlXIncludeCtxt *ctxt) {
 #ifdef LIBXML_XPTR_ENABLED
     if (ctxt->xpctxt != NULL)
 	xmlXPathFreeContext(ctxt->xpctxt);
+    xmlHashFree(ctxt->xptrCache, xmlXIncludeFreeXPointer);
 #endif
     xmlFree(ctxt);
 }
 
+/************************************************************************
+ *									*
+ *			Shared document cache				*
+ *									*
+ ************************************************************************/
+
+/**
+ * Create a cache of included documents and text resources which
+ * can be shared between XInclude contexts, see #xmlXIncludeSetCache.
+ *
+ * XML documents are stored as snapshots keyed by URL and parser
+ * flags. Each inclusion works on a fresh copy of the snapshot, so
+ * cached documents are never modified. Text resources are keyed by
+ * URL and encoding. The least recently used entries are evicted when
+ * the estimated memory usage would exceed `maxSize` bytes.
+ *
+ * Only resources which were loaded without errors or warnings are
+ * cached. The cache assumes that resources don't change, call
+ * #xmlXIncludeCacheClear after modifying them.
+ *
+ * The cache can be used by contexts in multiple threads at the same
+ * time.
+ *
+ * @since 2.16.0
+ *
+ * @param maxSize  maximum memory usage in bytes
+ * @returns the cache or NULL if a memory allocation failed.
+ */
+xmlXIncludeCache *
+xmlXIncludeNewCache(size_t maxSize) {
+    xmlXIncludeCache *cache;
+
+    xmlInitParser();
+
+    cache = xmlMalloc(sizeof(*cache));
+    if (cache == NULL)
+        return(NULL);
+    memset(cache, 0, sizeof(*cache));
+    cache->max = maxSize;
+    xmlInitMutex(&cache->mutex);
+
+    return(cache);
+}
+
+static void
+xmlXIncludeCacheFreeEntry(xmlXIncludeCacheEntry *entry) {
+    xmlFreeDocSnapshot(entry->snap);
+    xmlFree(entry->text);
+    xmlFree(entry->url);
+    xmlFree(entry->variant);
+    xmlFree(entry);
+}
+
+/**
+ * Unlink a cache entry and free it unless a copy is in progress.
+ * The cache mutex must be held.
+ *
+ * @param cache  the cache
+ * @param entry  the entry
+ */
+static void
+xmlXIncludeCacheRemove(xmlXIncludeCache *cache,
+                       xmlXIncludeCacheEntry *entry) {
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->first = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->last = entry->prev;
+
+    xmlHashRemoveEntry2(cache->hash, entry->url, entry->variant, NULL);
+    cache->used -= entry->size;
+
+    if (entry->refs > 0)
+        entry->removed = 1;
+    else
+        xmlXIncludeCacheFreeEntry(entry);
+}
+
+/**
+ * Evict least recently used entries until the cache uses at most
+ * `max` bytes. The cache mutex must be held.
+ *
+ * @param cache  the cache
+ * @param max  maximum size in bytes
+ */
+static void
+xmlXIncludeCacheEvict(xmlXIncludeCache *cache, size_t max) {
+    while ((cache->last != NULL) && (cache->used > max))
+        xmlXIncludeCacheRemove(cache, cache->last);
+}
+
+/**
+ * Free all entries of a cache. Documents and text already included
+ * aren't affected.
+ *
+ * This function is thread-safe.
+ *
+ * @since 2.16.0
+ *
+ * @param cache  the cache
+ */
+void
+xmlXIncludeCacheClear(xmlXIncludeCache *cache) {
+    if (cache == NULL)
+        return;
+
+    xmlMutexLock(&cache->mutex);
+    xmlXIncludeCacheEvict(cache, 0);
+    xmlMutexUnlock(&cache->mutex);
+}
+
+/**
+ * Free a cache. It must not be used by any XInclude context anymore.
+ *
+ * @since 2.16.0
+ *
+ * @param cache  the cache
+ */
+void
+xmlXIncludeFreeCache(xmlXIncludeCache *cache) {
+    if (cache == NULL)
+        return;
+
+    xmlXIncludeCacheEvict(cache, 0);
+    xmlHashFree(cache->hash, NULL);
+    xmlCleanupMutex(&cache->mutex);
+    xmlFree(cache);
+}
+
+/**
+ * Find an entry and move it to the front. The cache mutex must be
+ * held.
+ *
+ * @param cache  the cache
+ * @param url  the URL
+ * @param variant  the secondary key
+ * @returns the entry or NULL if not found.
+ */
+static xmlXIncludeCacheEntry *
+xmlXIncludeCacheLookup(xmlXIncludeCache *cache, const xmlChar *url,
+                       const xmlChar *variant) {
+    xmlXIncludeCacheEntry *entry;
+
+    if (cache->hash == NULL)
+        return(NULL);
+    entry = xmlHashLookup2(cache->hash, url, variant);
+    if ((entry != NULL) && (entry->prev != NULL)) {
+        entry->prev->next = entry->next;
+        if (entry->next != NULL)
+            entry->next->prev = entry->prev;
+        else
+            cache->last = entry->prev;
+        entry->prev = NULL;
+        entry->next = cache->first;
+        cache->first->prev = entry;
+        cache->first = entry;
+    }
+
+    return(entry);
+}
+
+/**
+ * Add a snapshot or text to the cache. Takes ownership of `snap`
+ * and `text` which are freed if they can't be cached.
+ *
+ * @param cache  the cache
+ * @param url  the URL
+ * @param variant  the secondary key
+ * @param snap  a document snapshot
+ * @param text  a text resource
+ * @param size  estimated memory usage
+ */
+static void
+xmlXIncludeCacheAdd(xmlXIncludeCache *cache, const xmlChar *url,
+                    const xmlChar *variant, xmlDocSnapshotPtr snap,
+                    xmlChar *text, size_t size) {
+    xmlXIncludeCacheEntry *entry = NULL;
+
+    size += sizeof(*entry) + xmlStrlen(url) + xmlStrlen(variant);
+
+    xmlMutexLock(&cache->mutex);
+
+    /* Stored by another thread in the meantime? */
+    if ((size > cache->max) ||
+        ((cache->hash != NULL) &&
+         (xmlHashLookup2(cache->hash, url, variant) != NULL)))
+        goto done;
+    if (cache->hash == NULL) {
+        cache->hash = xmlHashCreate(0);
+        if (cache->hash == NULL)
+            goto done;
+    }
+
+    xmlXIncludeCacheEvict(cache, cache->max - size);
+
+    entry = xmlMalloc(sizeof(*entry));
+    if (entry == NULL)
+        goto done;
+    memset(entry, 0, sizeof(*entry));
+    entry->url = xmlStrdup(url);
+    entry->variant = xmlStrdup(variant);
+    if ((entry->url == NULL) || (entry->variant == NULL) ||
+        (xmlHashAdd2(cache->hash, url, variant, entry) < 0))
+        goto done;
+    entry->snap = snap;
+    entry->text = text;
+    entry->size = size;
+    snap = NULL;
+    text = NULL;
+
+    entry->next = cache->first;
+    if (cache->first != NULL)
+        cache->first->prev = entry;
+    else
+        cache->last = entry;
+    cache->first = entry;
+    cache->used += size;
+    entry = NULL;
+
+done:
+    xmlMutexUnlock(&cache->mutex);
+    if (entry != NULL)
+        xmlXIncludeCacheFreeEntry(entry);
+    xmlFreeDocSnapshot(snap);
+    xmlFree(text);
+}
+
+static void
+xmlXIncludeCacheDocVariant(int flags, xmlChar *buf, size_t size) {
+    snprintf((char *) buf, size, "xml:%d", flags);
+}
+
+/**
+ * Make a copy of a cached document.
+ *
+ * @param cache  the cache
+ * @param url  the URL
+ * @param flags  the parser flags
+ * @returns the copy or NULL if the document isn't cached or a
+ * memory allocation failed.
+ */
+static xmlDocPtr
+xmlXIncludeCacheFetchDoc(xmlXIncludeCache *cache, const xmlChar *url,
+                         int flags) {
+    xmlXIncludeCacheEntry *entry;
+    xmlDocPtr doc;
+    xmlChar variant[30];
+
+    xmlXIncludeCacheDocVariant(flags, variant, sizeof(variant));
+
+    xmlMutexLock(&cache->mutex);
+    entry = xmlXIncludeCacheLookup(cache, url, variant);
+    if ((entry != NULL) && (entry->snap != NULL))
+        entry->refs++;
+    else
+        entry = NULL;
+    xmlMutexUnlock(&cache->mutex);
+
+    if (entry == NULL)
+        return(NULL);
+
+    /* Copy without holding the lock, the snapshot isn't modified */
+    doc = xmlDocSnapshotCopy(entry->snap);
+
+    xmlMutexLock(&cache->mutex);
+    entry->refs--;
+    if ((entry->removed) && (entry->refs == 0))
+        xmlXIncludeCacheFreeEntry(entry);
+    xmlMutexUnlock(&cache->mutex);
+
+    return(doc);
+}
+
+/**
+ * Store a snapshot of a parsed document in the cache.
+ *
+ * The snapshot gets its own concurrent dictionary: copies made in
+ * different threads share it and the dictionary of the original
+ * document belongs to the including document.
+ *
+ * @param cache  the cache
+ * @param url  the URL
+ * @param flags  the parser flags
+ * @param doc  the document
+ */
+static void
+xmlXIncludeCacheStoreDoc(xmlXIncludeCache *cache, const xmlChar *url,
+                         int flags, xmlDocPtr doc) {
+    struct _xmlMemBudget *budget;
+    xmlDocSnapshotPtr snap;
+    xmlDictPtr dict, oldDict;
+    xmlChar variant[30];
+    int found;
+
+    xmlXIncludeCacheDocVariant(flags, variant, sizeof(variant));
+
+    /* Avoid the snapshot if another context stored the document */
+    xmlMutexLock(&cache->mutex);
+    found = ((cache->hash != NULL) &&
+             (xmlHashLookup2(cache->hash, url, variant) != NULL));
+    xmlMutexUnlock(&cache->mutex);
+    if (found)
+        return;
+
+    /* Cache entries must not be charged to a parser's memory budget */
+    budget = xmlMemBudgetSuspend();
+
+    dict = xmlDictCreateConcurrent();
+    if (dict != NULL) {
+        /* Names are only shared if they're owned by the new dict */
+        oldDict = doc->dict;
+        doc->dict = dict;
+        snap = xmlNewDocSnapshot(doc);
+        doc->dict = oldDict;
+        xmlDictFree(dict);
+
+        if (snap != NULL)
+            xmlXIncludeCacheAdd(cache, url, variant, snap, NULL,
+                                xmlDocSnapshotSize(snap));
+    }
+
+    xmlMemBudgetLeave(budget);
+}
+
+/**
+ * Create a text node from a cached text resource.
+ *
+ * @param ctxt  the XInclude context
+ * @param url  the URL
+ * @param encoding  the encoding attribute (optional)
+ * @param node  the new text node
+ * @returns 1 if the text was found, 0 if not, -1 if a memory
+ * allocation failed.
+ */
+static int
+xmlXIncludeCacheFetchText(xmlXIncludeCtxtPtr ctxt, const xmlChar *url,
+                          const xmlChar *encoding, xmlNodePtr *node) {
+    xmlXIncludeCache *cache = ctxt->sharedCache;
+    xmlXIncludeCacheEntry *entry;
+    xmlChar *variant;
+    int ret = 0;
+
+    variant = xmlStrncatNew(BAD_CAST "text:", encoding, -1);
+    if (variant == NULL)
+        return(-1);
+
+    xmlMutexLock(&cache->mutex);
+    entry = xmlXIncludeCacheLookup(cache, url, variant);
+    if ((entry != NULL) && (entry->text != NULL)) {
+        *node = xmlNewDocText(ctxt->doc, entry->text);
+        ret = (*node != NULL) ? 1 : -1;
+    }
+    xmlMutexUnlock(&cache->mutex);
+
+    xmlFree(variant);
+    return(ret);
+}
+
+/**
+ * Store a text resource in the cache.
+ *
+ * @param cache  the cache
+ * @param url  the URL
+ * @param encoding  the encoding attribute (optional)
+ * @param text  the text
+ */
+static void
+xmlXIncludeCacheStoreText(xmlXIncludeCache *cache, const xmlChar *url,
+                          const xmlChar *encoding, const xmlChar *text) {
+    struct _xmlMemBudget *budget;
+    xmlChar *variant, *copy;
+
+    budget = xmlMemBudgetSuspend();
+
+    variant = xmlStrncatNew(BAD_CAST "text:", encoding, -1);
+    copy = xmlStrdup((text != NULL) ? text : BAD_CAST "");
+    if ((variant != NULL) && (copy != NULL))
+        xmlXIncludeCacheAdd(cache, url, variant, NULL, copy,
+                            xmlStrlen(copy) + 1);
+    else
+        xmlFree(copy);
+    xmlFree(variant);
+
+    xmlMemBudgetLeave(budget);
+}
+
 /**
  * parse a document for XInclude
  *
@@ -324,6 +757,13 @@ xmlXIncludeParseFile(xmlXIncludeCtxtPtr ctxt, const char *URL) {
 
     xmlInitParser();
 
+    if (ctxt->sharedCache != NULL) {
+        ret = xmlXIncludeCacheFetchDoc(ctxt->sharedCache, BAD_CAST URL,
+                                       ctxt->parseFlags);
+        if (ret != NULL)
+            return(ret);
+    }
+
     pctxt = xmlNewParserCtxt();
     if (pctxt == NULL) {
 	xmlXIncludeErrMemory(ctxt);
@@ -370,6 +810,10 @@ xmlXIncludeParseFile(xmlXIncludeCtxtPtr ctxt, const char *URL) {
 
     if (pctxt->wellFormed) {
         ret = pctxt->myDoc;
+        if ((ctxt->sharedCache != NULL) &&
+            (pctxt->nbErrors == 0) && (pctxt->nbWarnings == 0))
+            xmlXIncludeCacheStoreDoc(ctxt->sharedCache, BAD_CAST URL,
+                                     ctxt->parseFlags, ret);
     }
     else {
         ret = NULL;
@@ -812,6 +1256,45 @@ error:
 }
 
 #ifdef LIBXML_XPTR_ENABLED
+/**
+ * Get the compiled form of an XPointer expression. Expressions are
+ * compiled once per context since documents often include many
+ * fragments with the same XPointer.
+ *
+ * @param ctxt  the XInclude context
+ * @param fragment  the XPointer expression
+ * @returns the compiled expression owned by the context or NULL in
+ * case of error.
+ */
+static xmlXPtrCompExprPtr
+xmlXIncludeCompileXPointer(xmlXIncludeCtxtPtr ctxt, const xmlChar *fragment) {
+    xmlXPtrCompExprPtr comp;
+
+    comp = xmlHashLookup(ctxt->xptrCache, fragment);
+    if (comp != NULL)
+        return(comp);
+
+    comp = xmlXPtrCompile(fragment, ctxt->xpctxt);
+    if (comp == NULL)
+        return(NULL);
+
+    if (ctxt->xptrCache == NULL) {
+        ctxt->xptrCache = xmlHashCreate(0);
+        if (ctxt->xptrCache == NULL) {
+            xmlXPtrFreeCompExpr(comp);
+            xmlXIncludeErrMemory(ctxt);
+            return(NULL);
+        }
+    }
+    if (xmlHashAddEntry(ctxt->xptrCache, fragment, comp) < 0) {
+        xmlXPtrFreeCompExpr(comp);
+        xmlXIncludeErrMemory(ctxt);
+        return(NULL);
+    }
+
+    return(comp);
+}
+
 /**
  * Build a node list tree copy of the XPointer result.
  * This will drop Attributes and Namespace declarations.
@@ -1090,6 +1573,33 @@ xmlXIncludeLoadDoc(xmlXIncludeCtxtPtr ctxt, xmlXIncludeRefPtr ref) {
                                "inclusion loop detected\n", NULL);
                 goto error;
             }
+            if (ctxt->urlTab[i].pending) {
+                int flags = ctxt->parseFlags;
+
+                /*
+                 * Parsed ahead of time by xmlXIncludePrefetch. Parse
+                 * again if this first reference needs other flags.
+                 */
+#ifdef LIBXML_XPTR_ENABLED
+                if (fragment != NULL)
+                    flags |= XML_PARSE_NOENT;
+#endif
+                cacheNr = i;
+                cache = &ctxt->urlTab[i];
+                cache->pending = 0;
+                doc = cache->doc;
+                if (cache->parseFlags != flags) {
+                    int oldFlags = ctxt->parseFlags;
+
+                    xmlFreeDoc(doc);
+                    ctxt->parseFlags = flags;
+                    doc = xmlXIncludeParseFile(ctxt, (const char *) url);
+                    ctxt->parseFlags = oldFlags;
+                    /* urlTab isn't modified while parsing */
+                    cache->doc = doc;
+                }
+                goto parsed;
+            }
 	    doc = ctxt->urlTab[i].doc;
             if (doc == NULL)
                 goto error;
@@ -1147,8 +1657,10 @@ xmlXIncludeLoadDoc(xmlXIncludeCtxtPtr ctxt, xmlXIncludeRefPtr ref) {
         goto error;
     }
     cache->expanding = 0;
+    cache->pending = 0;
     cacheNr = ctxt->urlNr++;
 
+parsed:
     if (doc == NULL)
         goto error;
     /*
@@ -1211,6 +1723,7 @@ loaded:
 	 * as the replacement copy.
 	 */
 	xmlXPathObjectPtr xptr;
+	xmlXPtrCompExprPtr comp;
 	xmlNodeSetPtr set;
 
         if (ctxt->isStream && doc == ctxt->doc) {
@@ -1235,7 +1748,13 @@ loaded:
         } else {
             ctxt->xpctxt->doc = doc;
         }
-	xptr = xmlXPtrEval(fragment, ctxt->xpctxt);
+        comp = xmlXIncludeCompileXPointer(ctxt, fragment);
+        if (comp != NULL)
+            xptr = xmlXPtrCompiledEval(comp, ctxt->xpctxt);
+        else if (ctxt->xpctxt->lastError.code == XML_ERR_OK)
+            goto error; /* cache allocation failed */
+        else
+            xptr = NULL;
 	if (ctxt->xpctxt->lastError.code != XML_ERR_OK) {
             if (ctxt->xpctxt->lastError.code == XML_ERR_NO_MEMORY)
                 xmlXIncludeErrMemory(ctxt);
@@ -1395,6 +1914,16 @@ xmlXIncludeLoadTxt(xmlXIncludeCtxtPtr ctxt, xmlXIncludeRefPtr ref) {
         }
     }
 
+    if (ctxt->sharedCache != NULL) {
+        res = xmlXIncludeCacheFetchText(ctxt, url, encoding, &node);
+        if (res < 0) {
+            xmlXIncludeErrMemory(ctxt);
+            goto error;
+        }
+        if (res > 0)
+            goto cached;
+    }
+
     /*
      * Load it.
      */
@@ -1470,7 +1999,11 @@ xmlXIncludeLoadTxt(xmlXIncludeCtxtPtr ctxt, xmlXIncludeRefPtr ref) {
 
     if (xmlNodeAddContentLen(node, content, len) < 0)
         xmlXIncludeErrMemory(ctxt);
+    else if (ctxt->sharedCache != NULL)
+        xmlXIncludeCacheStoreText(ctxt->sharedCache, url, encoding,
+                                  node->content);
 
+cached:
     if (ctxt->txtNr >= ctxt->txtMax) {
         xmlXIncludeTxt *tmp;
         int newSize;
@@ -1866,6 +2399,320 @@ xmlXIncludeTestNode(xmlXIncludeCtxtPtr ctxt, xmlNodePtr node) {
     return(0);
 }
 
+#ifdef XML_XINCLUDE_PARALLEL
+typedef struct {
+    xmlChar *url;               /* the resolved URL */
+    int flags;                  /* the parser flags */
+    int errors;                 /* number of errors and warnings */
+    xmlDocPtr doc;              /* the parsed document */
+} xmlXIncludePrefetchItem;
+
+typedef struct {
+    xmlXIncludeCtxtPtr ctxt;    /* only read by workers */
+    xmlXIncludePrefetchItem *items;
+    int nbItems;
+    int next;                   /* next item to parse */
+    xmlMutex lock;
+} xmlXIncludePrefetchRun;
+
+static void
+xmlXIncludePrefetchError(void *data, const xmlError *error ATTRIBUTE_UNUSED) {
+    (*(int *) data)++;
+}
+
+/*
+ * Get an XInclude attribute without reporting errors
+ */
+static xmlChar *
+xmlXIncludePrefetchProp(xmlNodePtr cur, const xmlChar *name, int legacy) {
+    xmlChar *ret = NULL;
+
+    xmlNodeGetAttrValue(cur, name, XINCLUDE_NS, &ret);
+    if ((ret == NULL) && (legacy))
+        xmlNodeGetAttrValue(cur, name, XINCLUDE_OLD_NS, &ret);
+    if (ret == NULL)
+        xmlNodeGetAttrValue(cur, name, NULL, &ret);
+    return(ret);
+}
+
+/**
+ * Resolve the URL of an XML inclusion like #xmlXIncludeAddNode, but
+ * without side effects. Anything unusual is left to the sequential
+ * code which reports the errors.
+ *
+ * @param ctxt  the XInclude context
+ * @param cur  an xi:include element
+ * @param flags  the parser flags for the document
+ * @returns the URL or NULL if the document shouldn't be prefetched
+ */
+static xmlChar *
+xmlXIncludePrefetchURL(xmlXIncludeCtxtPtr ctxt, xmlNodePtr cur, int *flags) {
+    xmlURIPtr uri = NULL;
+    xmlChar *href = NULL, *parse = NULL, *fragment = NULL;
+    xmlChar *base = NULL, *tmp = NULL, *url = NULL;
+    int legacy;
+
+    legacy = (ctxt->legacy) || (xmlStrEqual(cur->ns->href, XINCLUDE_OLD_NS));
+    href = xmlXIncludePrefetchProp(cur, XINCLUDE_HREF, legacy);
+    parse = xmlXIncludePrefetchProp(cur, XINCLUDE_PARSE, legacy);
+    fragment = xmlXIncludePrefetchProp(cur, XINCLUDE_PARSE_XPOINTER, legacy);
+    if ((href == NULL) || (href[0] == 0) ||
+        (xmlStrlen(href) > XML_MAX_URI_LENGTH) ||
+        ((parse != NULL) && (!xmlStrEqual(parse, XINCLUDE_PARSE_XML))))
+        goto done;
+
+    if (xmlParseURISafe((const char *) href, &uri) != 0)
+        goto done;
+    if (uri->fragment != NULL) {
+        if (!legacy)
+            goto done;
+        if (fragment == NULL)
+            fragment = xmlStrdup(BAD_CAST "");
+    }
+    xmlFree(uri->fragment);
+    uri->fragment = NULL;
+    tmp = xmlSaveUri(uri);
+    if ((tmp == NULL) || (tmp[0] == 0))
+        goto done;
+
+    if (xmlNodeGetBaseSafe(ctxt->doc, cur, &base) < 0)
+        goto done;
+    if ((xmlBuildURISafe(tmp, base, &url) < 0) || (url == NULL))
+        goto done;
+    if (xmlStrEqual(url, ctxt->doc->URL)) {
+        xmlFree(url);
+        url = NULL;
+        goto done;
+    }
+
+    *flags = ctxt->parseFlags;
+#ifdef LIBXML_XPTR_ENABLED
+    if (fragment != NULL)
+        *flags |= XML_PARSE_NOENT;
+#endif
+
+done:
+    xmlFreeURI(uri);
+    xmlFree(href);
+    xmlFree(parse);
+    xmlFree(fragment);
+    xmlFree(base);
+    xmlFree(tmp);
+    return(url);
+}
+
+/*
+ * Parse a document in a worker thread like xmlXIncludeParseFile. The
+ * XInclude context isn't modified, errors are only counted.
+ */
+static void
+xmlXIncludePrefetchParse(xmlXIncludeCtxtPtr ctxt,
+                         xmlXIncludePrefetchItem *item) {
+    xmlParserCtxtPtr pctxt;
+    xmlParserInputPtr inputStream;
+
+    if (ctxt->sharedCache != NULL) {
+        item->doc = xmlXIncludeCacheFetchDoc(ctxt->sharedCache, item->url,
+                                             item->flags);
+        if (item->doc != NULL)
+            return;
+    }
+
+    pctxt = xmlNewParserCtxt();
+    if (pctxt == NULL) {
+        item->errors++;
+        return;
+    }
+    xmlCtxtSetErrorHandler(pctxt, xmlXIncludePrefetchError, &item->errors);
+    if (ctxt->resourceLoader != NULL)
+        xmlCtxtSetResourceLoader(pctxt, ctxt->resourceLoader,
+                                 ctxt->resourceCtxt);
+    pctxt->_private = ctxt->_private;
+    xmlCtxtUseOptions(pctxt, item->flags | XML_PARSE_DTDLOAD);
+
+    inputStream = xmlLoadResource(pctxt, (const char *) item->url, NULL,
+                                  XML_RESOURCE_XINCLUDE);
+    if ((inputStream != NULL) &&
+        (xmlCtxtPushInput(pctxt, inputStream) < 0)) {
+        xmlFreeInputStream(inputStream);
+        inputStream = NULL;
+    }
+    if (inputStream != NULL) {
+        xmlParseDocument(pctxt);
+        if ((pctxt->wellFormed) && (item->errors == 0)) {
+            item->doc = pctxt->myDoc;
+            if (ctxt->sharedCache != NULL)
+                xmlXIncludeCacheStoreDoc(ctxt->sharedCache, item->url,
+                                         item->flags, item->doc);
+        } else
+            xmlFreeDoc(pctxt->myDoc);
+        pctxt->myDoc = NULL;
+    }
+    xmlFreeParserCtxt(pctxt);
+}
+
+static void
+xmlXIncludePrefetchWork(void *data) {
+    xmlXIncludePrefetchRun *run = data;
+    int i;
+
+    while (1) {
+        xmlMutexLock(&run->lock);
+        i = run->next;
+        if (i < run->nbItems)
+            run->next++;
+        xmlMutexUnlock(&run->lock);
+        if (i >= run->nbItems)
+            break;
+
+        xmlXIncludePrefetchParse(run->ctxt, &run->items[i]);
+    }
+}
+
+/**
+ * Parse the distinct documents included from `tree` with multiple
+ * threads and add them to the document cache. The calling thread
+ * takes part in parsing.
+ *
+ * Prefetched documents are only marked as pending, entity merging,
+ * base fixup and recursive processing still happen in document
+ * order in #xmlXIncludeLoadDoc. Documents which fail to load or
+ * raise any diagnostics are dropped and loaded again sequentially,
+ * so errors are reported exactly as without prefetching.
+ *
+ * @param ctxt  the XInclude context
+ * @param tree  the top of the tree to process
+ */
+static void
+xmlXIncludePrefetch(xmlXIncludeCtxtPtr ctxt, xmlNodePtr tree) {
+    xmlXIncludePrefetchRun run;
+    xmlHashTablePtr seen;
+    xmlNodePtr cur;
+    xmlTaskGroup *group;
+    int maxItems = 0;
+    int nbThreads, i;
+
+    seen = xmlHashCreate(0);
+    if (seen == NULL)
+        return;
+    for (i = 0; i < ctxt->urlNr; i++)
+        xmlHashAddEntry(seen, ctxt->urlTab[i].url, seen);
+
+    memset(&run, 0, sizeof(run));
+    run.ctxt = ctxt;
+
+    /*
+     * Collect the distinct URLs in document order, like the first
+     * phase of xmlXIncludeDoProcess.
+     */
+    cur = tree;
+    do {
+        if ((cur->type == XML_ELEMENT_NODE) && (cur->ns != NULL) &&
+            (xmlStrEqual(cur->name, XINCLUDE_NODE)) &&
+            ((xmlStrEqual(cur->ns->href, XINCLUDE_NS)) ||
+             (xmlStrEqual(cur->ns->href, XINCLUDE_OLD_NS)))) {
+            xmlChar *url;
+            int flags = 0;
+
+            url = xmlXIncludePrefetchURL(ctxt, cur, &flags);
+            if ((url != NULL) && (xmlHashAddEntry(seen, url, seen) == 0)) {
+                if (run.nbItems >= maxItems) {
+                    xmlXIncludePrefetchItem *tmp;
+                    int newSize;
+
+                    newSize = xmlGrowCapacity(maxItems, sizeof(tmp[0]),
+                                              16, XML_MAX_ITEMS);
+                    tmp = (newSize < 0) ? NULL :
+                          xmlRealloc(run.items, newSize * sizeof(tmp[0]));
+                    if (tmp == NULL) {
+                        xmlFree(url);
+                        goto done;
+                    }
+                    run.items = tmp;
+                    maxItems = newSize;
+                }
+                memset(&run.items[run.nbItems], 0, sizeof(run.items[0]));
+                run.items[run.nbItems].url = url;
+                run.items[run.nbItems].flags = flags;
+                run.nbItems++;
+            } else {
+                xmlFree(url);
+            }
+        } else if ((cur->children != NULL) &&
+                   ((cur->type == XML_DOCUMENT_NODE) ||
+                    (cur->type == XML_ELEMENT_NODE))) {
+            cur = cur->children;
+            continue;
+        }
+        do {
+            if (cur == tree)
+                break;
+            if (cur->next != NULL) {
+                cur = cur->next;
+                break;
+            }
+            cur = cur->parent;
+        } while (cur != NULL);
+    } while ((cur != NULL) && (cur != tree));
+
+    /* A single document is loaded as fast in sequence */
+    if (run.nbItems < 2)
+        goto done;
+
+    nbThreads = ctxt->parallelThreads;
+    if (nbThreads > run.nbItems)
+        nbThreads = run.nbItems;
+
+    xmlInitMutex(&run.lock);
+    group = xmlNewTaskGroup();
+    for (i = 1; i < nbThreads; i++)
+        xmlTaskGroupSubmit(group, xmlXIncludePrefetchWork, &run);
+    xmlXIncludePrefetchWork(&run);
+    xmlFreeTaskGroup(group);
+    xmlCleanupMutex(&run.lock);
+
+    /*
+     * Add the documents to the cache
+     */
+    for (i = 0; i < run.nbItems; i++) {
+        xmlXIncludePrefetchItem *item = &run.items[i];
+        xmlXIncludeDoc *cache;
+
+        if (item->doc == NULL)
+            continue;
+        if (ctxt->urlNr >= ctxt->urlMax) {
+            xmlXIncludeDoc *tmp;
+            int newSize;
+
+            newSize = xmlGrowCapacity(ctxt->urlMax, sizeof(tmp[0]),
+                                      8, XML_MAX_ITEMS);
+            tmp = (newSize < 0) ? NULL :
+                  xmlRealloc(ctxt->urlTab, newSize * sizeof(tmp[0]));
+            if (tmp == NULL)
+                break;
+            ctxt->urlMax = newSize;
+            ctxt->urlTab = tmp;
+        }
+        cache = &ctxt->urlTab[ctxt->urlNr++];
+        cache->doc = item->doc;
+        cache->url = item->url;
+        cache->expanding = 0;
+        cache->pending = 1;
+        cache->parseFlags = item->flags;
+        item->doc = NULL;
+        item->url = NULL;
+    }
+
+done:
+    for (i = 0; i < run.nbItems; i++) {
+        xmlFreeDoc(run.items[i].doc);
+        xmlFree(run.items[i].url);
+    }
+    xmlFree(run.items);
+    xmlHashFree(seen, NULL);
+}
+#endif /* XML_XINCLUDE_PARALLEL */
+
 /**
  * Implement the XInclude substitution on the XML document `doc`
  *
@@ -1881,6 +2728,11 @@ xmlXIncludeDoProcess(xmlXIncludeCtxtPtr ctxt, xmlNodePtr tree) {
     int ret = 0;
     int i, start;
 
+#ifdef XML_XINCLUDE_PARALLEL
+    if ((ctxt->parallelThreads > 1) && (!ctxt->isStream))
+        xmlXIncludePrefetch(ctxt, tree);
+#endif
+
     /*
      * First phase: lookup the elements in the document
      */
@@ -2014,6 +2866,60 @@ xmlXIncludeSetResourceLoader(xmlXIncludeCtxt *ctxt,
     ctxt->resourceCtxt = data;
 }
 
+/**
+ * Load included XML documents with multiple threads.
+ *
+ * Before the included elements of a tree are processed, the distinct
+ * documents they reference are parsed with up to `nbThreads` threads.
+ * The documents are still included in document order and documents
+ * which fail to load are loaded again sequentially, so the result and
+ * errors are the same as without this option. Error handlers are only
+ * invoked from the calling thread, but a custom resource loader must
+ * be thread-safe. Text includes are always loaded sequentially.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XInclude processing context
+ * @param nbThreads  maximum number of threads or 0 to disable
+ * @returns 0 on success or -1 if threads aren't supported.
+ */
+int
+xmlXIncludeSetParallel(xmlXIncludeCtxt *ctxt, int nbThreads) {
+    if (ctxt == NULL)
+        return(-1);
+
+    if (nbThreads <= 1) {
+        ctxt->parallelThreads = 0;
+        return(0);
+    }
+
+#ifdef XML_XINCLUDE_PARALLEL
+    ctxt->parallelThreads = nbThreads;
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+/**
+ * Use a cache of included documents shared with other contexts, see
+ * #xmlXIncludeNewCache. Documents and text resources are looked up
+ * in the cache before they're loaded and added after they were
+ * loaded successfully. The cache must not be freed before the
+ * context.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  an XInclude processing context
+ * @param cache  the cache or NULL to stop using a cache
+ */
+void
+xmlXIncludeSetCache(xmlXIncludeCtxt *ctxt, xmlXIncludeCache *cache) {
+    if (ctxt == NULL)
+        return;
+    ctxt->sharedCache = cache;
+}
+
 /**
  * Set the flags used for further processing of XML resources.
  *
@@ -12,6 +12,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -23,11 +24,22 @@
   #include <direct.h>
 #else
   #include <unistd.h>
+  #include <sys/uio.h>
+#endif
+
+#if HAVE_DECL_MMAP
+  #include <sys/mman.h>
+  #if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+    #define MAP_ANONYMOUS MAP_ANON
+  #endif
 #endif
 
 #ifdef LIBXML_ZLIB_ENABLED
 #include <zlib.h>
 #endif
+#ifdef LIBXML_ZSTD_ENABLED
+#include <zstd.h>
+#endif
 
 #include <libxml/xmlIO.h>
 #include <libxml/xmlmemory.h>
@@ -42,6 +54,13 @@
 #include "private/enc.h"
 #include "private/error.h"
 #include "private/io.h"
+#include "private/simd.h"
+#include "private/trace.h"
+
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #include <pthread.h>
+  #define XML_ASYNC_IO
+#endif
 
 #ifndef SIZE_MAX
   #define SIZE_MAX ((size_t) -1)
@@ -51,6 +70,14 @@
 
 #define MINLEN 4000
 
+/*
+ * Upper limit for the read size of input buffers. Starting from
+ * MINLEN, the read size doubles each time a read callback fills the
+ * whole buffer, so long sequential parses end up with this block size
+ * while short documents and pipes keep using small reads.
+ */
+#define MAXREADLEN (2 * 1024 * 1024)
+
 #ifndef STDOUT_FILENO
   #define STDOUT_FILENO 1
 #endif
@@ -67,6 +94,14 @@
 #  endif
 #endif
 
+#ifndef S_ISREG
+#  if defined(S_IFMT) && defined(S_IFREG)
+#    define S_ISREG(m) (((m) & S_IFMT) == S_IFREG)
+#  elif defined(_S_IFMT) && defined(_S_IFREG)
+#    define S_ISREG(m) (((m) & _S_IFMT) == _S_IFREG)
+#  endif
+#endif
+
 /*
  * Input I/O callback sets
  */
@@ -158,6 +193,93 @@ xmlSerializeHexCharRef(char *buf, int val) {
 
 #include "codegen/escape.inc"
 
+/*
+ * @param out  output buffer or NULL to only measure
+ * @param string  start of the text
+ * @param end  end of the text
+ * @param tab  escape table
+ * @param flags  XML_ESCAPE flags
+ *
+ * Copy runs of text which don't need escaping in bulk and replace
+ * the characters between them.
+ *
+ * @returns the size of the escaped text.
+ */
+static size_t
+xmlEscapeTextInternal(xmlChar *out, const xmlChar *string,
+                      const xmlChar *end, const signed char *tab,
+                      int flags) {
+    const xmlChar *cur = string;
+    size_t size = 0;
+
+    while (1) {
+        char tempBuf[12];
+        const xmlChar *base;
+        const char *repl;
+        size_t replSize;
+        int offset = -1;
+        int c;
+
+        base = cur;
+
+        while (cur < end) {
+#ifdef XML_SIMD_ENABLED
+            if (end - cur >= 16) {
+                cur = xmlScanEscape(cur, end, flags & XML_ESCAPE_NON_ASCII);
+                if (cur >= end)
+                    break;
+            }
+#endif
+            c = *cur;
+
+            if (c < 0x80) {
+                offset = tab[c];
+                if (offset >= 0)
+                    break;
+            } else if (flags & XML_ESCAPE_NON_ASCII) {
+                break;
+            }
+
+            cur += 1;
+        }
+
+        if (out != NULL)
+            memcpy(out + size, base, cur - base);
+        size += cur - base;
+
+        if (cur >= end)
+            break;
+
+        if (offset >= 0) {
+            replSize = xmlEscapeContent[offset];
+            repl = &xmlEscapeContent[offset+1];
+            cur += 1;
+        } else {
+            int val, len;
+
+            len = (end - cur < 4) ? end - cur : 4;
+            val = xmlGetUTF8Char(cur, &len);
+            if (val < 0) {
+                val = 0xFFFD;
+                cur += 1;
+            } else {
+                if ((val == 0xFFFE) || (val == 0xFFFF))
+                    val = 0xFFFD;
+                cur += len;
+            }
+
+            replSize = xmlSerializeHexCharRef(tempBuf, val);
+            repl = tempBuf;
+        }
+
+        if (out != NULL)
+            memcpy(out + size, repl, replSize);
+        size += replSize;
+    }
+
+    return(size);
+}
+
 /*
  * @param text  input text
  * @param flags  XML_ESCAPE flags
@@ -168,16 +290,20 @@ xmlSerializeHexCharRef(char *buf, int val) {
  * - XML_ESCAPE_NON_ASCII: escape non-ASCII chars.
  * - XML_ESCAPE_HTML: for HTML content.
  * - XML_ESCAPE_QUOT: escape double quotes.
+ * - XML_ESCAPE_NO_COPY: return `text` itself if nothing needs
+ *   escaping.
+ *
+ * The size of the result is measured first, so the escaped string
+ * is allocated exactly once.
  *
  * @returns an escaped string or NULL if a memory allocation failed.
  */
 xmlChar *
 xmlEscapeText(const xmlChar *string, int flags) {
-    const xmlChar *cur;
+    const xmlChar *end;
     xmlChar *buffer;
-    xmlChar *out;
     const signed char *tab;
-    size_t size = 50;
+    size_t len, size;
 
 #ifdef LIBXML_HTML_ENABLED
     if (flags & XML_ESCAPE_HTML) {
@@ -197,114 +323,152 @@ xmlEscapeText(const xmlChar *string, int flags) {
             tab = xmlEscapeTab;
     }
 
+    len = strlen((const char *) string);
+    end = string + len;
+
+    /* A byte expands to at most 8 bytes like "&#xFFFD;" */
+    if (len > (SIZE_MAX - 1) / 8)
+        return(NULL);
+
+    /* Every replacement is longer than the text it replaces */
+    size = xmlEscapeTextInternal(NULL, string, end, tab, flags);
+    if ((size == len) && (flags & XML_ESCAPE_NO_COPY))
+        return((xmlChar *) string);
+
     buffer = xmlMalloc(size + 1);
     if (buffer == NULL)
         return(NULL);
-    out = buffer;
+    xmlEscapeTextInternal(buffer, string, end, tab, flags);
+    buffer[size] = 0;
+
+    return(buffer);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+/*
+ * @param buf  output buffer with a single-byte encoder
+ * @param string  start of the text
+ * @param end  end of the text
+ * @param tab  escape table
+ * @param flags  XML_ESCAPE flags
+ *
+ * Escape and encode text in a single pass, appending directly to the
+ * encoded output. Characters which can't be represented are written
+ * as character references right away instead of failing conversion.
+ *
+ * @returns 0 on success or if an error was set, -1 if pending output
+ * couldn't be converted and the caller must use the regular path.
+ */
+static int
+xmlSerializeTextEncoded(xmlOutputBuffer *buf, const xmlChar *string,
+                        const xmlChar *end, const signed char *tab,
+                        unsigned flags) {
+    const xmlChar *cur;
+    xmlBufPtr conv;
+
+    if (buf->error)
+        return(0);
+
+    if (buf->conv == NULL) {
+        buf->conv = xmlBufCreate(MINLEN);
+        if (buf->conv == NULL) {
+            buf->error = XML_ERR_NO_MEMORY;
+            return(0);
+        }
+    }
+    conv = buf->conv;
+
+    /* Convert pending output first to keep the order */
+    while (xmlBufUse(buf->buffer) > 0) {
+        if (xmlCharEncOutput(buf, 0) <= 0)
+            break;
+    }
+    if (buf->error)
+        return(0);
+    if (xmlBufUse(buf->buffer) > 0)
+        return(-1);
 
     cur = string;
 
-    while (*cur != 0) {
-        char tempBuf[12];
+    while (cur < end) {
         const xmlChar *base;
-        const char *repl;
-        size_t used;
-        size_t replSize;
-        size_t unescapedSize;
-        size_t totalSize;
-        int c;
-        int offset;
+        int c = 0;
+        int offset = -1;
 
         base = cur;
-        offset = -1;
 
-        while (1) {
+        while (cur < end) {
+#ifdef XML_SIMD_ENABLED
+            if (end - cur >= 16) {
+                cur = xmlScanEscape(cur, end, 1);
+                if (cur >= end)
+                    break;
+            }
+#endif
             c = *cur;
 
-            if (c < 0x80) {
-                offset = tab[c];
-                if (offset >= 0)
-                    break;
-            } else if (flags & XML_ESCAPE_NON_ASCII) {
+            if (c >= 0x80)
+                break;
+            offset = tab[c];
+            if (offset >= 0)
                 break;
-            }
 
             cur += 1;
         }
 
-        unescapedSize = cur - base;
+        if ((cur > base) && (xmlBufAdd(conv, base, cur - base) != 0))
+            goto mem_error;
+
+        if (cur >= end)
+            break;
 
         if (offset >= 0) {
-            if (c == 0) {
-                replSize = 0;
-                repl = "";
-            } else {
-                replSize = xmlEscapeContent[offset],
-                repl = &xmlEscapeContent[offset+1];
-                cur += 1;
-            }
+            if (xmlBufAdd(conv, BAD_CAST &xmlEscapeContent[offset+1],
+                          xmlEscapeContent[offset]) != 0)
+                goto mem_error;
+            cur += 1;
         } else {
-            int val = 0, len = 4;
+            char tempBuf[12];
+            int tempSize;
+            int val, len;
 
+            len = (end - cur < 4) ? end - cur : 4;
             val = xmlGetUTF8Char(cur, &len);
-            if (val < 0) {
-                val = 0xFFFD;
-                cur += 1;
-            } else {
-                if ((val == 0xFFFE) || (val == 0xFFFF))
+
+            if (flags & XML_ESCAPE_NON_ASCII) {
+                if (val < 0) {
                     val = 0xFFFD;
-                cur += len;
+                    len = 1;
+                } else if ((val == 0xFFFE) || (val == 0xFFFF)) {
+                    val = 0xFFFD;
+                }
+                tempSize = xmlSerializeHexCharRef(tempBuf, val);
+            } else {
+                if (val < 0) {
+                    buf->error = XML_ERR_INVALID_ENCODING;
+                    return(0);
+                }
+                tempSize = xmlCharEncOutputChar(buf->encoder, val, tempBuf);
             }
 
-            replSize = xmlSerializeHexCharRef(tempBuf, val);
-            repl = tempBuf;
-        }
-
-        used = out - buffer;
-        totalSize = unescapedSize + replSize;
-
-        if (totalSize > size - used) {
-            xmlChar *tmp;
-            int newSize;
-
-            if ((size > (SIZE_MAX - 1) / 2) ||
-                (totalSize > (SIZE_MAX - 1) / 2 - size)) {
-                xmlFree(buffer);
-                return(NULL);
-            }
-            newSize = size + totalSize;
-            if (*cur != 0)
-                newSize *= 2;
-            tmp = xmlRealloc(buffer, newSize + 1);
-            if (tmp == NULL) {
-                xmlFree(buffer);
-                return(NULL);
-            }
-            buffer = tmp;
-            size = newSize;
-            out = buffer + used;
+            if (xmlBufAdd(conv, BAD_CAST tempBuf, tempSize) != 0)
+                goto mem_error;
+            cur += len;
         }
-
-        memcpy(out, base, unescapedSize);
-        out += unescapedSize;
-        memcpy(out, repl, replSize);
-        out += replSize;
-
-        if (c == 0)
-            break;
-
-        base = cur;
     }
 
-    *out = 0;
-    return(buffer);
+    return(0);
+
+mem_error:
+    buf->error = XML_ERR_NO_MEMORY;
+    return(0);
 }
 
-#ifdef LIBXML_OUTPUT_ENABLED
 void
 xmlSerializeText(xmlOutputBuffer *buf, const xmlChar *string, size_t maxSize,
                  unsigned flags) {
     const xmlChar *cur;
+    const xmlChar *end;
     const signed char *tab;
 
     if (string == NULL)
@@ -328,6 +492,18 @@ xmlSerializeText(xmlOutputBuffer *buf, const xmlChar *string, size_t maxSize,
             tab = xmlEscapeTab;
     }
 
+    /*
+     * The text ends at maxSize or at a NUL byte, whichever comes first.
+     * memchr stops at the first match, so this is safe with SIZE_MAX.
+     */
+    end = memchr(string, 0, maxSize);
+    if (end == NULL)
+        end = string + maxSize;
+
+    if ((buf->encoder != NULL) && (xmlCharEncIsSingleByte(buf->encoder)) &&
+        (xmlSerializeTextEncoded(buf, string, end, tab, flags) == 0))
+        return;
+
     cur = string;
 
     while (1) {
@@ -339,9 +515,16 @@ xmlSerializeText(xmlOutputBuffer *buf, const xmlChar *string, size_t maxSize,
         offset = -1;
 
         while (1) {
-            if ((size_t) (cur - string) >= maxSize)
+            if (cur >= end)
                 break;
 
+#ifdef XML_SIMD_ENABLED
+            if (end - cur >= 16) {
+                cur = xmlScanEscape(cur, end, flags & XML_ESCAPE_NON_ASCII);
+                if (cur >= end)
+                    break;
+            }
+#endif
             c = (unsigned char) *cur;
 
             if (c < 0x80) {
@@ -358,12 +541,10 @@ xmlSerializeText(xmlOutputBuffer *buf, const xmlChar *string, size_t maxSize,
         if (cur > base)
             xmlOutputBufferWrite(buf, cur - base, (char *) base);
 
-        if ((size_t) (cur - string) >= maxSize)
+        if (cur >= end)
             break;
 
         if (offset >= 0) {
-            if (c == 0)
-                break;
 
             xmlOutputBufferWrite(buf, xmlEscapeContent[offset],
                                  &xmlEscapeContent[offset+1]);
@@ -769,6 +950,15 @@ xmlFdOpen(const char *filename, int write, int *out) {
             ret = xmlIOErr(errno);
         }
     } else {
+#if HAVE_DECL_POSIX_FADVISE
+        /*
+         * Files are parsed front to back. Let the kernel read ahead
+         * more aggressively. This is only a hint, so errors are
+         * ignored.
+         */
+        if (!write)
+            (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
         *out = fd;
         ret = XML_ERR_OK;
     }
@@ -1073,106 +1263,1117 @@ xmlBufferWrite (void * context, const char * buffer, int len) {
         return(-XML_ERR_NO_MEMORY);
     return(len);
 }
-#endif
 
-#ifdef LIBXML_ZLIB_ENABLED
-/************************************************************************
- *									*
- *		I/O for compressed file accesses			*
- *									*
- ************************************************************************/
+/*
+ * Minimum size of chunks of chunked output buffers
+ */
+#define XML_OUTPUT_CHUNK_SIZE 65536
+
+typedef struct _xmlOutputChunk xmlOutputChunk;
+struct _xmlOutputChunk {
+    xmlOutputChunk *next;
+    size_t size;
+    size_t use;
+    xmlChar data[1];
+};
+
+typedef struct {
+    xmlOutputChunk *first;
+    xmlOutputChunk *last;
+    size_t total;
+} xmlOutputChunks;
 
 /**
- * Read `len` bytes to `buffer` from the compressed I/O channel.
+ * Append `len` bytes from `buffer` to a list of chunks. Existing
+ * data is never moved.
  *
- * @param context  the I/O context
- * @param buffer  where to drop data
+ * @param context  the chunk list
+ * @param buffer  the data to write
  * @param len  number of bytes to write
- * @returns the number of bytes read.
+ * @returns the number of bytes written or a negative xmlParserErrors
+ * value.
  */
 static int
-xmlGzfileRead (void * context, char * buffer, int len) {
-    int ret;
+xmlOutputChunksWrite(void *context, const char *buffer, int len) {
+    xmlOutputChunks *chunks = context;
+    xmlOutputChunk *chunk = chunks->last;
+    size_t remaining = len;
 
-    ret = gzread((gzFile) context, &buffer[0], len);
-    if (ret < 0)
-        return(-XML_IO_UNKNOWN);
-    return(ret);
+    if (len <= 0)
+        return(0);
+    if (chunks->total > SIZE_MAX - 1 - remaining)
+        return(-XML_ERR_RESOURCE_LIMIT);
+
+    if (chunk != NULL) {
+        size_t n = chunk->size - chunk->use;
+
+        if (n > remaining)
+            n = remaining;
+        memcpy(&chunk->data[chunk->use], buffer, n);
+        chunk->use += n;
+        buffer += n;
+        remaining -= n;
+    }
+
+    if (remaining > 0) {
+        size_t size = XML_OUTPUT_CHUNK_SIZE;
+
+        if (size < remaining)
+            size = remaining;
+        chunk = xmlMalloc(sizeof(*chunk) + size);
+        if (chunk == NULL)
+            return(-XML_ERR_NO_MEMORY);
+        chunk->next = NULL;
+        chunk->size = size;
+        chunk->use = remaining;
+        memcpy(chunk->data, buffer, remaining);
+
+        if (chunks->last == NULL)
+            chunks->first = chunk;
+        else
+            chunks->last->next = chunk;
+        chunks->last = chunk;
+    }
+
+    chunks->total += len;
+    return(len);
 }
 
-#ifdef LIBXML_OUTPUT_ENABLED
 /**
- * Write `len` bytes from `buffer` to the compressed I/O channel.
+ * Free all chunks in a list.
  *
- * @param context  the I/O context
- * @param buffer  where to drop data
- * @param len  number of bytes to write
- * @returns the number of bytes written
+ * @param chunks  the chunk list
  */
-static int
-xmlGzfileWrite (void * context, const char * buffer, int len) {
-    int ret;
+static void
+xmlOutputChunksReset(xmlOutputChunks *chunks) {
+    xmlOutputChunk *chunk, *next;
 
-    ret = gzwrite((gzFile) context, (char *) &buffer[0], len);
-    if (ret < 0)
-        return(-XML_IO_UNKNOWN);
-    return(ret);
+    for (chunk = chunks->first; chunk != NULL; chunk = next) {
+        next = chunk->next;
+        xmlFree(chunk);
+    }
+    chunks->first = NULL;
+    chunks->last = NULL;
+    chunks->total = 0;
 }
-#endif /* LIBXML_OUTPUT_ENABLED */
 
 /**
- * Close a compressed I/O channel
+ * Free a list of chunks.
  *
- * @param context  the I/O context
+ * @param context  the chunk list
+ * @returns 0
  */
 static int
-xmlGzfileClose (void * context) {
-    if (gzclose((gzFile) context) != Z_OK)
-        return(XML_IO_UNKNOWN);
+xmlOutputChunksClose(void *context) {
+    xmlOutputChunks *chunks = context;
+
+    xmlOutputChunksReset(chunks);
+    xmlFree(chunks);
     return(0);
 }
-#endif /* LIBXML_ZLIB_ENABLED */
+#endif
+
+#if defined(LIBXML_OUTPUT_ENABLED) && defined(XML_ASYNC_IO)
+/*
+ * Asynchronous output. The serializer fills one buffer while up to
+ * maxPending full buffers are written by a separate thread through
+ * the original callbacks of the output buffer.
+ */
+#define XML_ASYNC_OUTPUT_SIZE (64 * 1024)
+
+typedef struct {
+    char *data;
+    size_t len;
+} xmlAsyncOutputBuf;
+
+typedef struct {
+    xmlOutputWriteCallback writecallback;
+    xmlOutputCloseCallback closecallback;
+    void *context;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    size_t size;
+    int maxPending;
+    /* ring of maxPending + 1 buffers */
+    int nbufs;
+    xmlAsyncOutputBuf *bufs;
+    /* buffer filled by the serializer */
+    int fill;
+    /* next buffer written by the thread */
+    int head;
+    /* number of full buffers, protected by lock */
+    int pending;
+    int error;
+    int stop;
+} xmlAsyncWriter;
+
+static void *
+xmlAsyncWriterThread(void *data) {
+    xmlAsyncWriter *writer = data;
+
+    pthread_mutex_lock(&writer->lock);
+
+    while (1) {
+        xmlAsyncOutputBuf *buf;
+        const char *ptr;
+        size_t len;
+        int error = 0;
+
+        if (writer->pending == 0) {
+            if (writer->stop)
+                break;
+            pthread_cond_wait(&writer->cond, &writer->lock);
+            continue;
+        }
+
+        buf = &writer->bufs[writer->head];
+        pthread_mutex_unlock(&writer->lock);
+
+        ptr = buf->data;
+        len = buf->len;
+        while ((len > 0) && (!error)) {
+            int ret = writer->writecallback(writer->context, ptr, len);
+
+            if (ret <= 0) {
+                error = ((ret == -1) || (ret == 0)) ? XML_IO_WRITE : -ret;
+            } else {
+                ptr += ret;
+                len -= ret;
+            }
+        }
+        buf->len = 0;
+
+        pthread_mutex_lock(&writer->lock);
+        if ((error) && (!writer->error))
+            writer->error = error;
+        writer->head = (writer->head + 1) % writer->nbufs;
+        writer->pending -= 1;
+        pthread_cond_broadcast(&writer->cond);
+    }
+
+    pthread_mutex_unlock(&writer->lock);
+
+    return(NULL);
+}
+
+/**
+ * Hand the current buffer to the writer thread. Waits if the
+ * maximum number of buffers is pending.
+ *
+ * @param writer  the async writer
+ * @returns 0 on success or an xmlParserErrors code.
+ */
+static int
+xmlAsyncWriterQueue(xmlAsyncWriter *writer) {
+    int error;
+
+    pthread_mutex_lock(&writer->lock);
+    while ((writer->pending >= writer->maxPending) && (!writer->error))
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    error = writer->error;
+    if (!error) {
+        writer->pending += 1;
+        writer->fill = (writer->fill + 1) % writer->nbufs;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return(error);
+}
+
+/**
+ * Copy `len` bytes from `buffer` to the buffers of the writer thread.
+ *
+ * @param context  the async writer
+ * @param buffer  the data to write
+ * @param len  number of bytes to write
+ * @returns the number of bytes written or a negative xmlParserErrors
+ * value.
+ */
+static int
+xmlAsyncWriterWrite(void *context, const char *buffer, int len) {
+    xmlAsyncWriter *writer = context;
+    int remaining = len;
+
+    while (remaining > 0) {
+        xmlAsyncOutputBuf *buf = &writer->bufs[writer->fill];
+        size_t n = writer->size - buf->len;
+
+        if (n > (size_t) remaining)
+            n = remaining;
+        memcpy(buf->data + buf->len, buffer, n);
+        buf->len += n;
+        buffer += n;
+        remaining -= n;
+
+        if (buf->len == writer->size) {
+            int error = xmlAsyncWriterQueue(writer);
+
+            if (error)
+                return(-error);
+        }
+    }
+
+    return(len);
+}
+
+static void
+xmlAsyncWriterFree(xmlAsyncWriter *writer) {
+    int i;
+
+    if (writer->bufs != NULL) {
+        for (i = 0; i < writer->nbufs; i++)
+            xmlFree(writer->bufs[i].data);
+        xmlFree(writer->bufs);
+    }
+    xmlFree(writer);
+}
+
+/**
+ * Write the remaining data, stop the writer thread and close the
+ * original I/O channel.
+ *
+ * @param context  the async writer
+ * @returns 0 or an xmlParserErrors code
+ */
+static int
+xmlAsyncWriterClose(void *context) {
+    xmlAsyncWriter *writer = context;
+    int error = 0;
+    int ret;
+
+    if (writer->bufs[writer->fill].len > 0)
+        error = xmlAsyncWriterQueue(writer);
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    pthread_join(writer->thread, NULL);
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+
+    if (!error)
+        error = writer->error;
+
+    if (writer->closecallback != NULL) {
+        ret = writer->closecallback(writer->context);
+        if ((ret != XML_ERR_OK) && (!error))
+            error = (ret < 0) ? XML_IO_UNKNOWN : ret;
+    }
+
+    xmlAsyncWriterFree(writer);
+
+    return(error);
+}
+#endif /* LIBXML_OUTPUT_ENABLED && XML_ASYNC_IO */
+
+#ifdef LIBXML_ZLIB_ENABLED
+/************************************************************************
+ *									*
+ *		I/O for compressed file accesses			*
+ *									*
+ ************************************************************************/
+
+/**
+ * Read `len` bytes to `buffer` from the compressed I/O channel.
+ *
+ * @param context  the I/O context
+ * @param buffer  where to drop data
+ * @param len  number of bytes to write
+ * @returns the number of bytes read.
+ */
+static int
+xmlGzfileRead (void * context, char * buffer, int len) {
+    int ret;
+
+    ret = gzread((gzFile) context, &buffer[0], len);
+    if (ret < 0)
+        return(-XML_IO_UNKNOWN);
+    return(ret);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+/**
+ * Write `len` bytes from `buffer` to the compressed I/O channel.
+ *
+ * @param context  the I/O context
+ * @param buffer  where to drop data
+ * @param len  number of bytes to write
+ * @returns the number of bytes written
+ */
+static int
+xmlGzfileWrite (void * context, const char * buffer, int len) {
+    int ret;
+
+    ret = gzwrite((gzFile) context, (char *) &buffer[0], len);
+    if (ret < 0)
+        return(-XML_IO_UNKNOWN);
+    return(ret);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+/**
+ * Close a compressed I/O channel
+ *
+ * @param context  the I/O context
+ */
+static int
+xmlGzfileClose (void * context) {
+    if (gzclose((gzFile) context) != Z_OK)
+        return(XML_IO_UNKNOWN);
+    return(0);
+}
+#endif /* LIBXML_ZLIB_ENABLED */
+
+/************************************************************************
+ *									*
+ *			Input/output buffers				*
+ *									*
+ ************************************************************************/
+
+static int
+xmlIODefaultMatch(const char *filename ATTRIBUTE_UNUSED) {
+    return(1);
+}
+
+#if defined(LIBXML_ZLIB_ENABLED) || defined(LIBXML_ZSTD_ENABLED)
+
+#ifdef _WIN32
+typedef __int64 xmlFileOffset;
+#else
+typedef off_t xmlFileOffset;
+#endif
+
+static xmlFileOffset
+xmlSeek(int fd, xmlFileOffset offset, int whence) {
+#ifdef _WIN32
+    HANDLE h = (HANDLE) _get_osfhandle(fd);
+
+    /*
+     * Windows doesn't return an error on unseekable files like pipes.
+     */
+    if (h != INVALID_HANDLE_VALUE && GetFileType(h) != FILE_TYPE_DISK)
+        return -1;
+    return _lseeki64(fd, offset, whence);
+#else
+    return lseek(fd, offset, whence);
+#endif
+}
+
+#endif /* LIBXML_ZLIB_ENABLED || LIBXML_ZSTD_ENABLED */
+
+#ifdef LIBXML_ZSTD_ENABLED
+/************************************************************************
+ *									*
+ *		I/O for Zstandard compressed files			*
+ *									*
+ ************************************************************************/
+
+#define ZSTD_MAGIC "\x28\xB5\x2F\xFD"
+
+typedef struct {
+    int fd;
+    ZSTD_DStream *dstream;
+    ZSTD_CStream *cstream;
+    char *buf;
+    size_t bufSize;
+    ZSTD_inBuffer in;
+    size_t pending;
+    int eof;
+} xmlZstdIOCtxt;
+
+static void
+xmlZstdFree(xmlZstdIOCtxt *ctxt) {
+    if (ctxt->dstream != NULL)
+        ZSTD_freeDStream(ctxt->dstream);
+    if (ctxt->cstream != NULL)
+        ZSTD_freeCStream(ctxt->cstream);
+    xmlFree(ctxt->buf);
+    xmlFree(ctxt);
+}
+
+/**
+ * Create a Zstandard I/O context.
+ *
+ * @param fd  file descriptor, owned by the context on success
+ * @param level  compression level or -1 for input
+ * @returns the new context or NULL if a memory allocation failed.
+ */
+static xmlZstdIOCtxt *
+xmlZstdOpen(int fd, int level) {
+    xmlZstdIOCtxt *ctxt;
+
+    ctxt = xmlMalloc(sizeof(*ctxt));
+    if (ctxt == NULL)
+        return(NULL);
+    memset(ctxt, 0, sizeof(*ctxt));
+    ctxt->fd = fd;
+
+    if (level < 0) {
+        ctxt->dstream = ZSTD_createDStream();
+        if (ctxt->dstream == NULL)
+            goto error;
+        ctxt->bufSize = ZSTD_DStreamInSize();
+    } else {
+        ctxt->cstream = ZSTD_createCStream();
+        if (ctxt->cstream == NULL)
+            goto error;
+        if (ZSTD_isError(ZSTD_CCtx_setParameter(ctxt->cstream,
+                                                ZSTD_c_compressionLevel,
+                                                level)))
+            goto error;
+        ctxt->bufSize = ZSTD_CStreamOutSize();
+    }
+
+    ctxt->buf = xmlMalloc(ctxt->bufSize);
+    if (ctxt->buf == NULL)
+        goto error;
+    ctxt->in.src = ctxt->buf;
+
+    return(ctxt);
+
+error:
+    xmlZstdFree(ctxt);
+    return(NULL);
+}
+
+/**
+ * Read `len` bytes to `buffer` from the compressed I/O channel.
+ *
+ * @param context  the I/O context
+ * @param buffer  where to drop data
+ * @param len  number of bytes to read
+ * @returns the number of bytes read.
+ */
+static int
+xmlZstdRead(void *context, char *buffer, int len) {
+    xmlZstdIOCtxt *ctxt = context;
+    ZSTD_outBuffer out;
+
+    out.dst = buffer;
+    out.size = len;
+    out.pos = 0;
+
+    while (out.pos == 0) {
+        size_t ret, inPos;
+
+        if ((ctxt->in.pos >= ctxt->in.size) && (!ctxt->eof)) {
+            int bytes = read(ctxt->fd, ctxt->buf, ctxt->bufSize);
+
+            if (bytes < 0)
+                return(-xmlIOErr(errno));
+            if (bytes == 0)
+                ctxt->eof = 1;
+            ctxt->in.size = bytes;
+            ctxt->in.pos = 0;
+        }
+
+        inPos = ctxt->in.pos;
+        ret = ZSTD_decompressStream(ctxt->dstream, &out, &ctxt->in);
+        if (ZSTD_isError(ret))
+            return(-XML_IO_UNKNOWN);
+
+        if ((ctxt->in.pos != inPos) || (out.pos > 0)) {
+            /* Zero if the last frame is complete */
+            ctxt->pending = ret;
+        } else if (ctxt->eof) {
+            if (ctxt->pending != 0)
+                return(-XML_IO_UNKNOWN);
+            break;
+        }
+    }
+
+    return(out.pos);
+}
+
+/**
+ * Close a compressed input channel.
+ *
+ * @param context  the I/O context
+ * @returns 0 or an xmlParserErrors code
+ */
+static int
+xmlZstdReadClose(void *context) {
+    xmlZstdIOCtxt *ctxt = context;
+    int ret = close(ctxt->fd);
+
+    xmlZstdFree(ctxt);
+
+    if (ret < 0)
+        return(xmlIOErr(errno));
+    return(XML_ERR_OK);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+/**
+ * Compress data and write the output to the file.
+ *
+ * @param ctxt  the I/O context
+ * @param in  the input data
+ * @param mode  ZSTD_e_continue or ZSTD_e_end
+ * @returns 0 or an xmlParserErrors code
+ */
+static int
+xmlZstdCompress(xmlZstdIOCtxt *ctxt, ZSTD_inBuffer *in,
+                ZSTD_EndDirective mode) {
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer out;
+        const char *ptr;
+
+        out.dst = ctxt->buf;
+        out.size = ctxt->bufSize;
+        out.pos = 0;
+
+        remaining = ZSTD_compressStream2(ctxt->cstream, &out, in, mode);
+        if (ZSTD_isError(remaining))
+            return(XML_IO_UNKNOWN);
+
+        ptr = ctxt->buf;
+        while (out.pos > 0) {
+            int bytes = write(ctxt->fd, ptr, out.pos);
+
+            if (bytes < 0)
+                return(xmlIOErr(errno));
+            ptr += bytes;
+            out.pos -= bytes;
+        }
+    } while ((mode == ZSTD_e_end) ? (remaining != 0) :
+                                    (in->pos < in->size));
+
+    return(XML_ERR_OK);
+}
+
+/**
+ * Write `len` bytes from `buffer` to the compressed I/O channel.
+ *
+ * @param context  the I/O context
+ * @param buffer  where to get data
+ * @param len  number of bytes to write
+ * @returns the number of bytes written
+ */
+static int
+xmlZstdWrite(void *context, const char *buffer, int len) {
+    ZSTD_inBuffer in;
+    int code;
+
+    in.src = buffer;
+    in.size = len;
+    in.pos = 0;
+
+    code = xmlZstdCompress(context, &in, ZSTD_e_continue);
+    if (code != XML_ERR_OK)
+        return(-code);
+
+    return(len);
+}
+
+/**
+ * Finish the compressed frame and close the output channel.
+ *
+ * @param context  the I/O context
+ * @returns 0 or an xmlParserErrors code
+ */
+static int
+xmlZstdWriteClose(void *context) {
+    xmlZstdIOCtxt *ctxt = context;
+    ZSTD_inBuffer in;
+    int code;
+
+    in.src = NULL;
+    in.size = 0;
+    in.pos = 0;
+
+    code = xmlZstdCompress(ctxt, &in, ZSTD_e_end);
+    if ((close(ctxt->fd) < 0) && (code == XML_ERR_OK))
+        code = xmlIOErr(errno);
+
+    xmlZstdFree(ctxt);
+
+    return(code);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+/**
+ * Check whether a file starts with a Zstandard frame and restore
+ * the file offset.
+ *
+ * @param fd  file descriptor
+ * @returns 1 if the file is compressed, 0 otherwise.
+ */
+static int
+xmlZstdDetect(int fd) {
+    xmlFileOffset pos;
+    char magic[4];
+    int len = 0;
+    int bytes;
+
+    pos = xmlSeek(fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return(0);
+
+    while (len < 4) {
+        bytes = read(fd, magic + len, 4 - len);
+        if (bytes <= 0)
+            break;
+        len += bytes;
+    }
+
+    if (xmlSeek(fd, pos, SEEK_SET) < 0)
+        return(0);
+
+    return((len == 4) && (memcmp(magic, ZSTD_MAGIC, 4) == 0));
+}
+#endif /* LIBXML_ZSTD_ENABLED */
+
+#if HAVE_DECL_MMAP
+
+typedef struct {
+    void *map;
+    size_t size;
+} xmlMmapIOCtxt;
+
+static int
+xmlMmapClose(void *context) {
+    xmlMmapIOCtxt *mmapctxt = context;
+
+    munmap(mmapctxt->map, mmapctxt->size);
+    xmlFree(mmapctxt);
+
+    return(XML_ERR_OK);
+}
+
+/**
+ * Try to map a regular file into memory and replace the content
+ * buffer with a static buffer pointing to the mapping.
+ *
+ * The parser needs a terminating zero byte. If the file size is a
+ * multiple of the page size, an extra anonymous page is reserved
+ * after the file contents.
+ *
+ * @param buf  parser input buffer
+ * @param fd  file descriptor
+ * @returns 0 on success, -1 if the file can't be mapped.
+ */
+static int
+xmlInputFromMmap(xmlParserInputBuffer *buf, int fd) {
+    xmlMmapIOCtxt *mmapctxt;
+    xmlBufPtr mem;
+    struct stat st;
+    size_t size, mapSize;
+    long pageSize;
+    void *map;
+
+    if ((buf->encoder != NULL) ||
+        (fstat(fd, &st) < 0) ||
+        (!S_ISREG(st.st_mode)) ||
+        (st.st_size <= 0) ||
+        (lseek(fd, 0, SEEK_CUR) != 0))
+        return(-1);
+
+    pageSize = sysconf(_SC_PAGESIZE);
+    if ((pageSize <= 0) ||
+        ((unsigned long long) st.st_size >= SIZE_MAX - pageSize))
+        return(-1);
+
+    size = st.st_size;
+    mapSize = size;
+
+    if (size % pageSize == 0) {
+#ifdef MAP_ANONYMOUS
+        mapSize += pageSize;
+        map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                   -1, 0);
+        if (map == MAP_FAILED)
+            return(-1);
+        if (mmap(map, size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                 fd, 0) == MAP_FAILED) {
+            munmap(map, mapSize);
+            return(-1);
+        }
+#else
+        return(-1);
+#endif
+    } else {
+        map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            return(-1);
+    }
+
+    mmapctxt = xmlMalloc(sizeof(*mmapctxt));
+    if (mmapctxt == NULL) {
+        munmap(map, mapSize);
+        return(-1);
+    }
+    mmapctxt->map = map;
+    mmapctxt->size = mapSize;
+
+    mem = xmlBufCreateMem(map, size, 1);
+    if (mem == NULL) {
+        xmlMmapClose(mmapctxt);
+        return(-1);
+    }
+
+    xmlBufFree(buf->buffer);
+    buf->buffer = mem;
+    buf->context = mmapctxt;
+    buf->readcallback = NULL;
+    buf->closecallback = xmlMmapClose;
+
+    return(0);
+}
+
+#endif /* HAVE_DECL_MMAP */
+
+/**
+ * Map a regular file into memory, preferably at `addr`. Read-only
+ * mappings share their pages with all processes mapping the same
+ * file. Writable mappings are private copy-on-write mappings and
+ * ignore `addr`. Without mmap support, the file is read into memory.
+ *
+ * @param filename  the file name or URI
+ * @param addr  preferred address, NULL for any
+ * @param writable  whether the memory will be modified
+ * @param map  pointer to the start of the file in memory
+ * @param size  pointer to the size of the file
+ * @returns an xmlParserErrors code
+ */
+xmlParserErrors
+xmlMapFile(const char *filename, void *addr, int writable, void **map,
+           size_t *size) {
+    struct stat st;
+    xmlParserErrors ret;
+    void *mem;
+    int fd;
+
+    *map = NULL;
+    *size = 0;
+
+    ret = xmlFdOpen(filename, 0, &fd);
+    if (ret != XML_ERR_OK)
+        return(ret);
+    if ((fstat(fd, &st) < 0) ||
+        (!S_ISREG(st.st_mode)) ||
+        (st.st_size <= 0) ||
+        ((unsigned long long) st.st_size >= SIZE_MAX)) {
+        close(fd);
+        return(XML_IO_EINVAL);
+    }
+
+#if HAVE_DECL_MMAP
+    if (writable)
+        mem = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                   fd, 0);
+    else
+        mem = mmap(addr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED) {
+        ret = xmlIOErr(errno);
+        close(fd);
+        return(ret);
+    }
+#else
+    {
+        size_t len = 0;
+        int bytes;
+
+        (void) addr;
+        (void) writable;
+
+        mem = xmlMalloc(st.st_size);
+        if (mem == NULL) {
+            close(fd);
+            return(XML_ERR_NO_MEMORY);
+        }
+        while (len < (size_t) st.st_size) {
+            size_t n = st.st_size - len;
+
+            bytes = read(fd, (char *) mem + len, n > INT_MAX ? INT_MAX : n);
+            if (bytes <= 0) {
+                ret = (bytes < 0) ? xmlIOErr(errno) : XML_IO_EIO;
+                xmlFree(mem);
+                close(fd);
+                return(ret);
+            }
+            len += bytes;
+        }
+    }
+#endif
+
+    close(fd);
+    *map = mem;
+    *size = st.st_size;
+    return(XML_ERR_OK);
+}
+
+/**
+ * Release memory returned by #xmlMapFile.
+ *
+ * @param map  start of the file in memory
+ * @param size  size of the file
+ */
+void
+xmlUnmapFile(void *map, size_t size) {
+#if HAVE_DECL_MMAP
+    munmap(map, size);
+#else
+    (void) size;
+    xmlFree(map);
+#endif
+}
+
+#ifdef XML_ASYNC_IO
+
+/*
+ * Read-ahead of regular files. A separate thread keeps up to
+ * ASYNC_SLOTS chunks of the file queued ahead of the parser. Slots
+ * are filled in order by the thread and consumed in order by
+ * xmlAsyncRead.
+ *
+ * The thread reads through the original callbacks of the input
+ * buffer, so compressed files are decompressed ahead of the parser,
+ * too. This is done by default for compressed files larger than
+ * ASYNC_MIN_COMPRESSED.
+ */
+#define ASYNC_SLOTS 4
+#define ASYNC_CHUNK (128 * 1024)
+#define ASYNC_MIN_COMPRESSED (1024 * 1024)
+
+typedef struct {
+    char *data;
+    int len;
+    int filled;
+} xmlAsyncSlot;
+
+typedef struct {
+    xmlInputReadCallback readcallback;
+    xmlInputCloseCallback closecallback;
+    void *context;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    xmlAsyncSlot slots[ASYNC_SLOTS];
+    /* next slot to fill, protected by lock */
+    int tail;
+    /* next slot to consume and offset into it, only used by readers */
+    int head;
+    int offset;
+    int eof;
+    int error;
+    int stop;
+} xmlAsyncIOCtxt;
+
+static void *
+xmlAsyncReadAhead(void *data) {
+    xmlAsyncIOCtxt *ctxt = data;
+
+    pthread_mutex_lock(&ctxt->lock);
+
+    while (!ctxt->stop) {
+        xmlAsyncSlot *slot = &ctxt->slots[ctxt->tail];
+        int len = 0;
+        int bytes = 0;
+
+        if (slot->filled) {
+            pthread_cond_wait(&ctxt->cond, &ctxt->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&ctxt->lock);
+        while (len < ASYNC_CHUNK) {
+            bytes = ctxt->readcallback(ctxt->context, slot->data + len,
+                                       ASYNC_CHUNK - len);
+            if (bytes <= 0)
+                break;
+            len += bytes;
+        }
+        pthread_mutex_lock(&ctxt->lock);
+
+        if (len > 0) {
+            slot->len = len;
+            slot->filled = 1;
+            ctxt->tail = (ctxt->tail + 1) % ASYNC_SLOTS;
+        }
+        if (bytes < 0) {
+            ctxt->error = (bytes == -1) ? XML_IO_UNKNOWN : -bytes;
+            break;
+        }
+        if (bytes == 0) {
+            ctxt->eof = 1;
+            break;
+        }
+
+        pthread_cond_broadcast(&ctxt->cond);
+    }
+
+    pthread_cond_broadcast(&ctxt->cond);
+    pthread_mutex_unlock(&ctxt->lock);
+
+    return(NULL);
+}
+
+/**
+ * Read `len` bytes to `buffer` from the read-ahead queue. Waits
+ * for the next chunk if the queue is empty.
+ *
+ * @param context  the I/O context
+ * @param buffer  where to drop data
+ * @param len  number of bytes to read
+ * @returns the number of bytes read
+ */
+static int
+xmlAsyncRead(void *context, char *buffer, int len) {
+    xmlAsyncIOCtxt *ctxt = context;
+    xmlAsyncSlot *slot = &ctxt->slots[ctxt->head];
+    int filled, error;
+    int ret;
+
+    pthread_mutex_lock(&ctxt->lock);
+    while ((!slot->filled) && (!ctxt->eof) && (!ctxt->error))
+        pthread_cond_wait(&ctxt->cond, &ctxt->lock);
+    filled = slot->filled;
+    error = ctxt->error;
+    pthread_mutex_unlock(&ctxt->lock);
+
+    if (!filled) {
+        if (error)
+            return(-error);
+        return(0);
+    }
+
+    /*
+     * The read-ahead thread doesn't touch filled slots until they're
+     * released below, so the data can be copied without holding the
+     * lock.
+     */
+
+    ret = slot->len - ctxt->offset;
+    if (ret > len)
+        ret = len;
+    memcpy(buffer, slot->data + ctxt->offset, ret);
+    ctxt->offset += ret;
+
+    if (ctxt->offset >= slot->len) {
+        ctxt->offset = 0;
+        ctxt->head = (ctxt->head + 1) % ASYNC_SLOTS;
+
+        pthread_mutex_lock(&ctxt->lock);
+        slot->filled = 0;
+        pthread_cond_broadcast(&ctxt->cond);
+        pthread_mutex_unlock(&ctxt->lock);
+    }
+
+    return(ret);
+}
+
+static void
+xmlAsyncFree(xmlAsyncIOCtxt *ctxt) {
+    int i;
+
+    for (i = 0; i < ASYNC_SLOTS; i++)
+        xmlFree(ctxt->slots[i].data);
+    xmlFree(ctxt);
+}
+
+/**
+ * Stop the read-ahead thread and close the original input.
+ *
+ * @param context  the I/O context
+ * @returns 0 in case of success and error code otherwise
+ */
+static int
+xmlAsyncClose(void *context) {
+    xmlAsyncIOCtxt *ctxt = context;
+    int ret = XML_ERR_OK;
+
+    pthread_mutex_lock(&ctxt->lock);
+    ctxt->stop = 1;
+    pthread_cond_broadcast(&ctxt->cond);
+    pthread_mutex_unlock(&ctxt->lock);
+
+    pthread_join(ctxt->thread, NULL);
+    pthread_cond_destroy(&ctxt->cond);
+    pthread_mutex_destroy(&ctxt->lock);
+
+    if (ctxt->closecallback != NULL)
+        ret = ctxt->closecallback(ctxt->context);
+    xmlAsyncFree(ctxt);
+
+    return(ret);
+}
+
+/**
+ * Try to start a thread which reads the input of `buf` ahead of the
+ * parser. Only regular files are supported, so that closing the
+ * input never blocks. On failure, the input is left unchanged.
+ *
+ * @param buf  parser input buffer with read and close callbacks
+ * @param fd  the file descriptor of the input
+ * @param minSize  minimum file size
+ */
+static void
+xmlInputMakeAsync(xmlParserInputBuffer *buf, int fd, off_t minSize) {
+    xmlAsyncIOCtxt *ctxt;
+    struct stat st;
+    int i;
 
-/************************************************************************
- *									*
- *			Input/output buffers				*
- *									*
- ************************************************************************/
+    if ((fstat(fd, &st) < 0) || (!S_ISREG(st.st_mode)) ||
+        (st.st_size < minSize))
+        return;
 
-static int
-xmlIODefaultMatch(const char *filename ATTRIBUTE_UNUSED) {
-    return(1);
-}
+    ctxt = xmlMalloc(sizeof(*ctxt));
+    if (ctxt == NULL)
+        return;
+    memset(ctxt, 0, sizeof(*ctxt));
 
-#if defined(LIBXML_ZLIB_ENABLED)
+    for (i = 0; i < ASYNC_SLOTS; i++) {
+        ctxt->slots[i].data = xmlMalloc(ASYNC_CHUNK);
+        if (ctxt->slots[i].data == NULL) {
+            xmlAsyncFree(ctxt);
+            return;
+        }
+    }
 
-#ifdef _WIN32
-typedef __int64 xmlFileOffset;
-#else
-typedef off_t xmlFileOffset;
-#endif
+    ctxt->readcallback = buf->readcallback;
+    ctxt->closecallback = buf->closecallback;
+    ctxt->context = buf->context;
 
-static xmlFileOffset
-xmlSeek(int fd, xmlFileOffset offset, int whence) {
-#ifdef _WIN32
-    HANDLE h = (HANDLE) _get_osfhandle(fd);
+    if (pthread_mutex_init(&ctxt->lock, NULL) != 0)
+        goto error;
+    if (pthread_cond_init(&ctxt->cond, NULL) != 0) {
+        pthread_mutex_destroy(&ctxt->lock);
+        goto error;
+    }
+    if (pthread_create(&ctxt->thread, NULL, xmlAsyncReadAhead, ctxt) != 0) {
+        pthread_cond_destroy(&ctxt->cond);
+        pthread_mutex_destroy(&ctxt->lock);
+        goto error;
+    }
 
-    /*
-     * Windows doesn't return an error on unseekable files like pipes.
-     */
-    if (h != INVALID_HANDLE_VALUE && GetFileType(h) != FILE_TYPE_DISK)
-        return -1;
-    return _lseeki64(fd, offset, whence);
-#else
-    return lseek(fd, offset, whence);
-#endif
+    buf->context = ctxt;
+    buf->readcallback = xmlAsyncRead;
+    buf->closecallback = xmlAsyncClose;
+
+    return;
+
+error:
+    xmlAsyncFree(ctxt);
 }
 
-#endif /* defined(LIBXML_ZLIB_ENABLED) */
+#endif /* XML_ASYNC_IO */
 
 /**
- * Update the buffer to read from `fd`. Supports the XML_INPUT_UNZIP
- * flag.
+ * Update the buffer to read from `fd`. Supports the XML_INPUT_UNZIP,
+ * XML_INPUT_MMAP and XML_INPUT_ASYNC flags. With XML_INPUT_UNZIP,
+ * seekable files starting with a Zstandard frame are decompressed
+ * if zstd support was compiled in. Compressed regular files larger
+ * than 1 MB are decompressed ahead of the parser in a separate thread
+ * if POSIX threads are available.
  *
  * @param buf  parser input buffer
  * @param fd  file descriptor
@@ -1187,6 +2388,34 @@ xmlInputFromFd(xmlParserInputBuffer *buf, int fd,
 
     (void) flags;
 
+#ifdef LIBXML_ZSTD_ENABLED
+    if ((flags & XML_INPUT_UNZIP) && (xmlZstdDetect(fd))) {
+        xmlZstdIOCtxt *zctxt;
+
+        copy = dup(fd);
+        if (copy == -1)
+            return(xmlIOErr(errno));
+
+        zctxt = xmlZstdOpen(copy, -1);
+        if (zctxt == NULL) {
+            close(copy);
+            return(XML_ERR_NO_MEMORY);
+        }
+
+        buf->context = zctxt;
+        buf->readcallback = xmlZstdRead;
+        buf->closecallback = xmlZstdReadClose;
+        buf->compressed = 1;
+
+#ifdef XML_ASYNC_IO
+        xmlInputMakeAsync(buf, fd, (flags & XML_INPUT_ASYNC) ?
+                                   0 : ASYNC_MIN_COMPRESSED);
+#endif
+
+        return(XML_ERR_OK);
+    }
+#endif /* LIBXML_ZSTD_ENABLED */
+
 #ifdef LIBXML_ZLIB_ENABLED
     if (flags & XML_INPUT_UNZIP) {
         gzFile gzStream;
@@ -1218,6 +2447,12 @@ xmlInputFromFd(xmlParserInputBuffer *buf, int fd,
                 buf->closecallback = xmlGzfileClose;
                 buf->compressed = compressed;
 
+#ifdef XML_ASYNC_IO
+                if ((compressed) || (flags & XML_INPUT_ASYNC))
+                    xmlInputMakeAsync(buf, fd, (flags & XML_INPUT_ASYNC) ?
+                                               0 : ASYNC_MIN_COMPRESSED);
+#endif
+
                 return(XML_ERR_OK);
             }
 
@@ -1226,6 +2461,12 @@ xmlInputFromFd(xmlParserInputBuffer *buf, int fd,
     }
 #endif /* LIBXML_ZLIB_ENABLED */
 
+#if HAVE_DECL_MMAP
+    if ((flags & XML_INPUT_MMAP) &&
+        (xmlInputFromMmap(buf, fd) == 0))
+        return(XML_ERR_OK);
+#endif
+
     copy = dup(fd);
     if (copy == -1)
         return(xmlIOErr(errno));
@@ -1241,6 +2482,11 @@ xmlInputFromFd(xmlParserInputBuffer *buf, int fd,
     buf->readcallback = xmlFdRead;
     buf->closecallback = xmlFdClose;
 
+#ifdef XML_ASYNC_IO
+    if (flags & XML_INPUT_ASYNC)
+        xmlInputMakeAsync(buf, fd, 0);
+#endif
+
     return(XML_ERR_OK);
 }
 
@@ -1272,6 +2518,29 @@ xmlOutputDefaultOpen(xmlOutputBufferPtr buf, const char *filename,
             return(ret);
     }
 
+#ifdef LIBXML_ZSTD_ENABLED
+    {
+        size_t len = strlen(filename);
+
+        if ((len > 4) && (strcmp(filename + len - 4, ".zst") == 0)) {
+            xmlZstdIOCtxt *zctxt;
+
+            zctxt = xmlZstdOpen(fd, (compression > 0) ? compression :
+                                    ZSTD_CLEVEL_DEFAULT);
+            if (zctxt == NULL) {
+                close(fd);
+                return(XML_ERR_NO_MEMORY);
+            }
+
+            buf->context = zctxt;
+            buf->writecallback = xmlZstdWrite;
+            buf->closecallback = xmlZstdWriteClose;
+
+            return(XML_ERR_OK);
+        }
+    }
+#endif /* LIBXML_ZSTD_ENABLED */
+
 #ifdef LIBXML_ZLIB_ENABLED
     if ((compression > 0) && (compression <= 9)) {
         gzFile gzStream;
@@ -1401,6 +2670,61 @@ xmlAllocOutputBuffer(xmlCharEncodingHandler *encoder) {
 }
 #endif /* LIBXML_OUTPUT_ENABLED */
 
+/**
+ * Take over the content of a parser input buffer.
+ *
+ * Memory-mapped content is handed over together with the mapping,
+ * which must be released with `release(releaseCtxt)`. Otherwise,
+ * `release` is set to NULL and the text must be freed with xmlFree.
+ * The buffer must not be used afterwards except for freeing it.
+ *
+ * @param in  a buffered parser input
+ * @param text  set to the zero-terminated content
+ * @param size  set to the size of the content
+ * @param release  set to the release callback
+ * @param releaseCtxt  set to the argument of the release callback
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+int
+xmlParserInputBufferTakeContent(xmlParserInputBuffer *in, xmlChar **text,
+                                size_t *size, xmlInputCloseCallback *release,
+                                void **releaseCtxt) {
+    xmlChar *content;
+
+    *text = NULL;
+    *size = 0;
+    *release = NULL;
+    *releaseCtxt = NULL;
+
+    if ((in == NULL) || (in->buffer == NULL))
+        return(-1);
+
+    *size = xmlBufUse(in->buffer);
+
+#if HAVE_DECL_MMAP
+    if (in->closecallback == xmlMmapClose) {
+        *text = xmlBufContent(in->buffer);
+        *release = in->closecallback;
+        *releaseCtxt = in->context;
+        in->closecallback = NULL;
+        in->context = NULL;
+        return(0);
+    }
+#endif
+
+    /* Static buffers can't be detached. */
+    content = xmlBufDetach(in->buffer);
+    if (content == NULL)
+        content = xmlStrndup(xmlBufContent(in->buffer), *size);
+    if (content == NULL) {
+        *size = 0;
+        return(-1);
+    }
+
+    *text = content;
+    return(0);
+}
+
 /**
  * Free up the memory used by a buffered parser input
  *
@@ -1843,6 +3167,378 @@ xmlOutputBufferGetSize(xmlOutputBuffer *out) {
     return(xmlBufUse(out->buffer));
 }
 
+/**
+ * Create a buffered output which stores the serialized data in
+ * memory as a list of fixed-size chunks. Unlike a memory buffer
+ * created with #xmlAllocOutputBuffer, data which was already
+ * written is never reallocated or copied when the output grows.
+ *
+ * Walk the chunks with #xmlOutputBufferNextChunk, for example to
+ * send them with writev, or copy them into a single allocation with
+ * #xmlOutputBufferFlatten.
+ *
+ * Consumes `encoder` but not in error case.
+ *
+ * @since 2.16.0
+ *
+ * @param encoder  the encoding converter or NULL
+ * @returns the new output buffer or NULL if a memory allocation failed.
+ */
+xmlOutputBuffer *
+xmlOutputBufferCreateChunked(xmlCharEncodingHandler *encoder) {
+    xmlOutputBufferPtr ret;
+    xmlOutputChunks *chunks;
+
+    chunks = xmlMalloc(sizeof(*chunks));
+    if (chunks == NULL)
+        return(NULL);
+    memset(chunks, 0, sizeof(*chunks));
+
+    ret = xmlOutputBufferCreateIO(xmlOutputChunksWrite, xmlOutputChunksClose,
+                                  chunks, encoder);
+    if (ret == NULL)
+        xmlFree(chunks);
+
+    return(ret);
+}
+
+/**
+ * Get the chunk list of a chunked output buffer after flushing
+ * pending data.
+ *
+ * @param out  an output buffer
+ * @returns the chunk list or NULL if `out` isn't a chunked output
+ * buffer or an error occurred.
+ */
+static xmlOutputChunks *
+xmlOutputBufferGetChunks(xmlOutputBuffer *out) {
+    if ((out == NULL) || (out->writecallback != xmlOutputChunksWrite) ||
+        (out->error != 0))
+        return(NULL);
+
+    if (xmlOutputBufferFlush(out) < 0)
+        return(NULL);
+
+    return(out->context);
+}
+
+/**
+ * Iterate the chunks of an output buffer created with
+ * #xmlOutputBufferCreateChunked. Set `*iter` to NULL to start with
+ * the first chunk. Pending data is flushed at the start of the
+ * iteration. Writing to the output buffer during an iteration
+ * invalidates the iterator.
+ *
+ * @since 2.16.0
+ *
+ * @param out  a chunked output buffer
+ * @param iter  iterator state, initialized to NULL
+ * @param len  set to the size of the chunk
+ * @returns a pointer to the chunk data or NULL if there are no more
+ * chunks or an error occurred.
+ */
+const xmlChar *
+xmlOutputBufferNextChunk(xmlOutputBuffer *out, void **iter, size_t *len) {
+    xmlOutputChunk *chunk;
+
+    if ((iter == NULL) || (len == NULL))
+        return(NULL);
+    *len = 0;
+
+    if (*iter == NULL) {
+        xmlOutputChunks *chunks = xmlOutputBufferGetChunks(out);
+
+        if (chunks == NULL)
+            return(NULL);
+        chunk = chunks->first;
+    } else {
+        chunk = ((xmlOutputChunk *) *iter)->next;
+    }
+
+    /* Skip empty chunks */
+    while ((chunk != NULL) && (chunk->use == 0))
+        chunk = chunk->next;
+
+    *iter = chunk;
+    if (chunk == NULL)
+        return(NULL);
+
+    *len = chunk->use;
+    return(chunk->data);
+}
+
+/**
+ * Copy the data of an output buffer created with
+ * #xmlOutputBufferCreateChunked into a single null-terminated
+ * allocation. The chunks are freed, so the output buffer is empty
+ * afterwards.
+ *
+ * @since 2.16.0
+ *
+ * @param out  a chunked output buffer
+ * @param len  optional pointer to the size of the result
+ * @returns the data, to be freed with xmlFree, or NULL if `out` isn't
+ * a chunked output buffer or an error occurred.
+ */
+xmlChar *
+xmlOutputBufferFlatten(xmlOutputBuffer *out, size_t *len) {
+    xmlOutputChunks *chunks;
+    xmlOutputChunk *chunk;
+    xmlChar *ret;
+    size_t pos = 0;
+
+    if (len != NULL)
+        *len = 0;
+
+    chunks = xmlOutputBufferGetChunks(out);
+    if (chunks == NULL)
+        return(NULL);
+
+    ret = xmlMalloc(chunks->total + 1);
+    if (ret == NULL) {
+        out->error = XML_ERR_NO_MEMORY;
+        return(NULL);
+    }
+
+    for (chunk = chunks->first; chunk != NULL; chunk = chunk->next) {
+        memcpy(&ret[pos], chunk->data, chunk->use);
+        pos += chunk->use;
+    }
+    ret[pos] = 0;
+
+    xmlOutputChunksReset(chunks);
+
+    if (len != NULL)
+        *len = pos;
+    return(ret);
+}
+
+#ifndef _WIN32
+/*
+ * Maximum number of chunks passed to a single writev call
+ */
+#if defined(IOV_MAX) && (IOV_MAX < 64)
+  #define CHUNK_IOV_MAX IOV_MAX
+#else
+  #define CHUNK_IOV_MAX 64
+#endif
+#endif
+
+/**
+ * Write the data of an output buffer created with
+ * #xmlOutputBufferCreateChunked to a file descriptor. The chunks
+ * are passed to the kernel directly with vectored writes, so unlike
+ * #xmlOutputBufferFlatten, the data is never copied. The chunks are
+ * freed afterwards, so the output buffer can be reused to send
+ * further data.
+ *
+ * The file descriptor is not closed. Partial writes and interrupted
+ * system calls are retried.
+ *
+ * @since 2.16.0
+ *
+ * @param out  a chunked output buffer
+ * @param fd  a file descriptor open for writing
+ * @returns the number of bytes written or -1 if `out` isn't a
+ * chunked output buffer or an error occurred.
+ */
+long
+xmlOutputBufferWriteChunksFd(xmlOutputBuffer *out, int fd) {
+    xmlOutputChunks *chunks;
+    xmlOutputChunk *chunk;
+    long ret = 0;
+
+    if (fd < 0)
+        return(-1);
+
+    chunks = xmlOutputBufferGetChunks(out);
+    if (chunks == NULL)
+        return(-1);
+
+    if (chunks->total > LONG_MAX) {
+        out->error = XML_ERR_RESOURCE_LIMIT;
+        return(-1);
+    }
+
+    chunk = chunks->first;
+
+#ifdef _WIN32
+    for (; chunk != NULL; chunk = chunk->next) {
+        const char *data = (const char *) chunk->data;
+        size_t len = chunk->use;
+
+        while (len > 0) {
+            unsigned n = (len > INT_MAX) ? INT_MAX : (unsigned) len;
+            int bytes = write(fd, data, n);
+
+            if (bytes < 0) {
+                if (errno == EINTR)
+                    continue;
+                out->error = xmlIOErr(errno);
+                return(-1);
+            }
+            data += bytes;
+            len -= bytes;
+            ret += bytes;
+        }
+    }
+#else
+    {
+        struct iovec iov[CHUNK_IOV_MAX];
+        int cur = 0, num = 0;
+
+        while (1) {
+            ssize_t bytes;
+
+            /* Refill the vector */
+            while ((num < CHUNK_IOV_MAX) && (chunk != NULL)) {
+                if (chunk->use > 0) {
+                    iov[num].iov_base = chunk->data;
+                    iov[num].iov_len = chunk->use;
+                    num++;
+                }
+                chunk = chunk->next;
+            }
+            if (cur >= num)
+                break;
+
+            bytes = writev(fd, &iov[cur], num - cur);
+            if (bytes < 0) {
+                if (errno == EINTR)
+                    continue;
+                out->error = xmlIOErr(errno);
+                return(-1);
+            }
+            ret += bytes;
+
+            /* Skip the vectors which were written completely */
+            while ((cur < num) && ((size_t) bytes >= iov[cur].iov_len)) {
+                bytes -= iov[cur].iov_len;
+                cur++;
+            }
+            if (cur < num) {
+                iov[cur].iov_base = (char *) iov[cur].iov_base + bytes;
+                iov[cur].iov_len -= bytes;
+            }
+
+            /* Move the partially written rest to the start */
+            if ((cur > 0) && (chunk != NULL)) {
+                memmove(iov, &iov[cur], (num - cur) * sizeof(iov[0]));
+                num -= cur;
+                cur = 0;
+            }
+        }
+    }
+#endif
+
+    xmlOutputChunksReset(chunks);
+
+    return(ret);
+}
+
+/**
+ * Switch an output buffer to asynchronous mode. Data is collected in
+ * buffers of `size` bytes. Full buffers are passed to the write
+ * callback from a separate thread while serialization continues. If
+ * `maxPending` buffers are waiting to be written, writes block
+ * until the thread catches up.
+ *
+ * In asynchronous mode, #xmlOutputBufferFlush only hands data over
+ * to the thread. Write errors are reported by later writes or by
+ * #xmlOutputBufferClose which waits until all data was written and
+ * then invokes the close callback.
+ *
+ * The write callback must be safe to call from another thread. This
+ * is the case for output buffers created from file names, file
+ * descriptors and FILE pointers. Chunked output buffers can't be
+ * switched to asynchronous mode.
+ *
+ * Only supported if the library was built with POSIX threads.
+ *
+ * @since 2.16.0
+ *
+ * @param out  an output buffer
+ * @param size  size of buffers, 0 for the default of 64 KB
+ * @param maxPending  maximum number of buffers waiting to be written,
+ * values less than 1 default to 1
+ * @returns 0 on success or -1 if asynchronous output isn't supported
+ * or an error occurred.
+ */
+int
+xmlOutputBufferSetAsync(xmlOutputBuffer *out, size_t size,
+                        int maxPending) {
+#ifdef XML_ASYNC_IO
+    xmlAsyncWriter *writer;
+    int i;
+
+    if ((out == NULL) || (out->error) ||
+        (out->writecallback == NULL) ||
+        (out->writecallback == xmlOutputChunksWrite) ||
+        (out->writecallback == xmlAsyncWriterWrite))
+        return(-1);
+
+    if (size == 0)
+        size = XML_ASYNC_OUTPUT_SIZE;
+    if (maxPending < 1)
+        maxPending = 1;
+    if ((size > INT_MAX) || (maxPending > 1000))
+        return(-1);
+
+    if (xmlOutputBufferFlush(out) < 0)
+        return(-1);
+
+    writer = xmlMalloc(sizeof(*writer));
+    if (writer == NULL)
+        return(-1);
+    memset(writer, 0, sizeof(*writer));
+    writer->writecallback = out->writecallback;
+    writer->closecallback = out->closecallback;
+    writer->context = out->context;
+    writer->size = size;
+    writer->maxPending = maxPending;
+    writer->nbufs = maxPending + 1;
+
+    writer->bufs = xmlMalloc(writer->nbufs * sizeof(writer->bufs[0]));
+    if (writer->bufs == NULL)
+        goto error;
+    memset(writer->bufs, 0, writer->nbufs * sizeof(writer->bufs[0]));
+    for (i = 0; i < writer->nbufs; i++) {
+        writer->bufs[i].data = xmlMalloc(size);
+        if (writer->bufs[i].data == NULL)
+            goto error;
+    }
+
+    if (pthread_mutex_init(&writer->lock, NULL) != 0)
+        goto error;
+    if (pthread_cond_init(&writer->cond, NULL) != 0) {
+        pthread_mutex_destroy(&writer->lock);
+        goto error;
+    }
+    if (pthread_create(&writer->thread, NULL, xmlAsyncWriterThread,
+                       writer) != 0) {
+        pthread_cond_destroy(&writer->cond);
+        pthread_mutex_destroy(&writer->lock);
+        goto error;
+    }
+
+    out->writecallback = xmlAsyncWriterWrite;
+    out->closecallback = xmlAsyncWriterClose;
+    out->context = writer;
+
+    return(0);
+
+error:
+    xmlAsyncWriterFree(writer);
+    return(-1);
+#else
+    (void) out;
+    (void) size;
+    (void) maxPending;
+
+    return(-1);
+#endif
+}
+
 
 #endif /* LIBXML_OUTPUT_ENABLED */
 
@@ -1967,6 +3663,31 @@ xmlNewInputBufferMemory(const void *mem, size_t size,
     return(ret);
 }
 
+/**
+ * Get the memory area streamed by a buffer created with
+ * #xmlNewInputBufferMemory if nothing was read from it yet.
+ *
+ * @param in  a buffered parser input
+ * @param mem  set to the start of the memory area
+ * @param size  set to the size of the memory area
+ * @returns 0 on success, -1 if the buffer doesn't stream from memory.
+ */
+int
+xmlParserInputBufferGetMemory(xmlParserInputBuffer *in, const xmlChar **mem,
+                              size_t *size) {
+    xmlMemIOCtxt *memCtxt;
+
+    if ((in == NULL) || (in->readcallback != xmlMemRead) ||
+        (in->encoder != NULL) || (in->buffer == NULL) ||
+        (xmlBufUse(in->buffer) != 0))
+        return(-1);
+
+    memCtxt = in->context;
+    *mem = (const xmlChar *) memCtxt->cur;
+    *size = memCtxt->size;
+    return(0);
+}
+
 /**
  * Create a parser input buffer for parsing from a memory area.
  *
@@ -2293,6 +4014,9 @@ xmlParserInputBufferGrow(xmlParserInputBuffer *in, int len) {
      * Call the read method for this I/O type.
      */
     if (in->readcallback != NULL) {
+        if (len < in->readsize)
+            len = in->readsize;
+
         xmlBufPtr buf;
 
         if (in->encoder == NULL) {
@@ -2320,6 +4044,8 @@ xmlParserInputBufferGrow(xmlParserInputBuffer *in, int len) {
 	res = in->readcallback(in->context, (char *)xmlBufEnd(buf), len);
 	if (res <= 0)
 	    in->readcallback = endOfInput;
+        else if ((res == len) && (len <= MAXREADLEN / 2))
+            in->readsize = len * 2;
         if (res < 0) {
             if (res == -1)
                 in->error = XML_IO_UNKNOWN;
@@ -2332,6 +4058,10 @@ xmlParserInputBufferGrow(xmlParserInputBuffer *in, int len) {
             in->error = XML_ERR_NO_MEMORY;
             return(-1);
         }
+
+        if (res > 0)
+            XML_TRACE_EVENT(input_grow, XML_TRACE_INPUT_GROW,
+                            (const char *) NULL, (long) res);
     }
 
     /*
@@ -2461,6 +4191,8 @@ xmlOutputBufferWrite(xmlOutputBuffer *out, int len, const char *data) {
 
             xmlBufShrink(buf, ret);
             written += ret;
+            XML_TRACE_EVENT(save_flush, XML_TRACE_SAVE_FLUSH,
+                            (const char *) NULL, (long) ret);
             if (out->written > INT_MAX - ret)
                 out->written = INT_MAX;
             else
@@ -2676,6 +4408,10 @@ xmlOutputBufferFlush(xmlOutputBuffer *out) {
     else
         out->written += ret;
 
+    if (ret > 0)
+        XML_TRACE_EVENT(save_flush, XML_TRACE_SAVE_FLUSH,
+                        (const char *) NULL, (long) ret);
+
     return(ret);
 }
 #endif /* LIBXML_OUTPUT_ENABLED */
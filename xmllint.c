@@ -34,6 +34,7 @@
 #endif
 
 #include <libxml/xmlmemory.h>
+#include <libxml/threads.h>
 #include <libxml/parser.h>
 #include <libxml/parserInternals.h>
 #include <libxml/HTMLparser.h>
@@ -163,13 +164,22 @@ typedef enum {
     /** Print trace of all external entities loaded */
     XML_LINT_USE_LOAD_TRACE = (1 << 23),
     /** Return application failure if document has any namespace errors */
-    XML_LINT_STRICT_NAMESPACE = (1 << 24)
+    XML_LINT_STRICT_NAMESPACE = (1 << 24),
+    /** Print the allocation call site profile */
+    XML_LINT_ALLOC_PROFILE = (1 << 25),
+    /** Print the evaluation profile of the XPath expression */
+    XML_LINT_XPATH_PROFILE = (1 << 26),
+    /** Print the profile of schema validation */
+    XML_LINT_SCHEMA_PROFILE = (1 << 27),
+    /** Print the benchmark report as JSON */
+    XML_LINT_BENCHMARK_JSON = (1 << 28)
 
 
 } xmllintAppOptions;
 
 typedef struct {
     FILE *errStream;
+    FILE *outStream;
     xmlParserCtxtPtr ctxt;
     xmlResourceLoader defaultResourceLoader;
 
@@ -200,6 +210,7 @@ typedef struct {
     xmlSchematronPtr wxschematron;
 #endif
     int repeat;
+    int jobs;
 #ifdef LIBXML_HTML_ENABLED
     int htmlOptions;
 #endif
@@ -217,6 +228,9 @@ typedef struct {
 #endif /* LIBXML_READER_ENABLED */
 #ifdef LIBXML_XPATH_ENABLED
     const char *xpathquery;
+#if defined(LIBXML_READER_ENABLED) && defined(LIBXML_PATTERN_ENABLED)
+    xmlPatternPtr xpathpatc;
+#endif
 #endif
     int parseOptions;
     unsigned appOptions;
@@ -227,11 +241,24 @@ typedef struct {
 
     xmlTime begin;
     xmlTime end;
+
+    /* benchmark mode */
+    int benchmark;
+    int warmup;
+    double *benchTimes;
+    xmlTime benchBegin;
+    size_t benchBase;
+    size_t benchAllocStart;
+    size_t benchAllocs;
+    size_t benchPeak;
+    unsigned long benchNodes;
 } xmllintState;
 
 static int xmllintMaxmem;
 static int xmllintMaxmemReached;
 static int xmllintOom;
+static size_t xmllintAllocs;
+static size_t xmllintPeak;
 
 /************************************************************************
  *									*
@@ -460,6 +487,18 @@ parseHtml(xmllintState *lint, const char *filename) {
 
 #define XMLLINT_ABORT_ON_FAILURE 0
 
+/*
+ * Update the allocation statistics used by --benchmark.
+ */
+static void
+myCountAlloc(void) {
+    size_t used = xmlMemUsed();
+
+    xmllintAllocs += 1;
+    if (used > xmllintPeak)
+        xmllintPeak = used;
+}
+
 static void
 myFreeFunc(void *mem) {
     xmlMemFree(mem);
@@ -481,6 +520,8 @@ myMallocFunc(size_t size) {
     ret = xmlMemMalloc(size);
     if (ret == NULL)
         xmllintOom = 1;
+    else
+        myCountAlloc();
 
     return(ret);
 }
@@ -502,6 +543,8 @@ myReallocFunc(void *mem, size_t size) {
     ret = xmlMemRealloc(mem, size);
     if (ret == NULL)
         xmllintOom = 1;
+    else
+        myCountAlloc();
 
     return(ret);
 }
@@ -529,12 +572,46 @@ myStrdupFunc(const char *str) {
         xmllintOom = 1;
         return(NULL);
     }
+    myCountAlloc();
 
     memcpy(ret, str, size);
 
     return(ret);
 }
 
+static void *
+benchMallocFunc(size_t size) {
+    void *ret;
+
+    ret = xmlMemMalloc(size);
+    if (ret != NULL)
+        myCountAlloc();
+
+    return(ret);
+}
+
+static void *
+benchReallocFunc(void *mem, size_t size) {
+    void *ret;
+
+    ret = xmlMemRealloc(mem, size);
+    if (ret != NULL)
+        myCountAlloc();
+
+    return(ret);
+}
+
+static char *
+benchStrdupFunc(const char *str) {
+    char *ret;
+
+    ret = xmlMemoryStrdup(str);
+    if (ret != NULL)
+        myCountAlloc();
+
+    return(ret);
+}
+
 /************************************************************************
  *									*
  * Internal timing routines to remove the necessity to have		*
@@ -591,6 +668,191 @@ endTimer(xmllintState *lint, const char *fmt, ...)
     fprintf(lint->errStream, " took %ld ms\n", (long) msec);
 }
 
+/************************************************************************
+ *									*
+ *			Benchmark mode					*
+ *									*
+ ************************************************************************/
+
+/*
+ * benchStart: call before each iteration of the pipeline
+ */
+static void
+benchStart(xmllintState *lint) {
+    if (lint->benchmark <= 0)
+        return;
+
+    lint->benchNodes = 0;
+    lint->benchBase = xmlMemUsed();
+    lint->benchAllocStart = xmllintAllocs;
+    xmllintPeak = lint->benchBase;
+    getTime(&lint->benchBegin);
+}
+
+/*
+ * benchStop: call after each iteration, warm-up iterations with
+ *            index below lint->warmup are not recorded
+ */
+static void
+benchStop(xmllintState *lint, int iter) {
+    xmlTime end;
+    double usec;
+
+    if (lint->benchmark <= 0)
+        return;
+
+    getTime(&end);
+    if (iter < lint->warmup)
+        return;
+
+    usec = (double) (end.sec - lint->benchBegin.sec) * 1000000.0 +
+           (double) (end.usec - lint->benchBegin.usec);
+    lint->benchTimes[iter - lint->warmup] = usec;
+    lint->benchAllocs += xmllintAllocs - lint->benchAllocStart;
+    if (xmllintPeak - lint->benchBase > lint->benchPeak)
+        lint->benchPeak = xmllintPeak - lint->benchBase;
+}
+
+static int
+benchCompare(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+
+    return((x > y) - (x < y));
+}
+
+static long
+benchFileSize(xmllintState *lint, const char *filename) {
+    FILE *f;
+    long size;
+
+#if HAVE_DECL_MMAP
+    if (lint->appOptions & XML_LINT_MEMORY)
+        return(lint->memorySize);
+#else
+    (void) lint;
+#endif
+
+    if (strcmp(filename, "-") == 0)
+        return(0);
+    f = fopen(filename, "rb");
+    if (f == NULL)
+        return(0);
+    if (fseek(f, 0, SEEK_END) != 0)
+        size = 0;
+    else
+        size = ftell(f);
+    fclose(f);
+
+    return(size < 0 ? 0 : size);
+}
+
+static void
+benchPrintJsonString(FILE *out, const char *str) {
+    const unsigned char *cur;
+
+    putc('"', out);
+    for (cur = (const unsigned char *) str; *cur != 0; cur++) {
+        if ((*cur == '"') || (*cur == '\\'))
+            fprintf(out, "\\%c", *cur);
+        else if (*cur < 0x20)
+            fprintf(out, "\\u%04x", *cur);
+        else
+            putc(*cur, out);
+    }
+    putc('"', out);
+}
+
+/*
+ * benchReport: print the statistics collected for one input.
+ *
+ * Throughput figures are derived from the median latency.
+ */
+static void
+benchReport(xmllintState *lint, const char *filename) {
+    FILE *out = lint->errStream;
+    double *times = lint->benchTimes;
+    int n = lint->benchmark;
+    double minMs, medianMs, p99Ms, mbps = 0.0, nodesps = 0.0;
+    long size;
+    int p99;
+
+    size = benchFileSize(lint, filename);
+
+    qsort(times, n, sizeof(times[0]), benchCompare);
+    minMs = times[0] / 1000.0;
+    if (n % 2)
+        medianMs = times[n / 2] / 1000.0;
+    else
+        medianMs = (times[n / 2 - 1] + times[n / 2]) / 2000.0;
+    /* nearest-rank percentile */
+    p99 = (n * 99 + 99) / 100 - 1;
+    p99Ms = times[p99] / 1000.0;
+
+    if (medianMs > 0.0) {
+        mbps = (double) size / (medianMs * 1000.0);
+        nodesps = (double) lint->benchNodes / (medianMs / 1000.0);
+    }
+
+    if (lint->appOptions & XML_LINT_BENCHMARK_JSON) {
+        fprintf(out, "{\"file\":");
+        benchPrintJsonString(out, filename);
+        fprintf(out, ",\"iterations\":%d,\"warmup\":%d,\"bytes\":%ld,"
+                "\"nodes\":%lu,\"min_ms\":%.3f,\"median_ms\":%.3f,"
+                "\"p99_ms\":%.3f,\"mb_per_s\":%.2f,\"nodes_per_s\":%.0f,"
+                "\"allocs\":%lu,\"peak_bytes\":%lu}\n",
+                n, lint->warmup, size, lint->benchNodes,
+                minMs, medianMs, p99Ms, mbps, nodesps,
+                (unsigned long) (lint->benchAllocs / n),
+                (unsigned long) lint->benchPeak);
+    } else {
+        fprintf(out, "%s: %d iterations after %d warm-up\n",
+                filename, n, lint->warmup);
+        fprintf(out, "  latency: min %.3f ms, median %.3f ms, p99 %.3f ms\n",
+                minMs, medianMs, p99Ms);
+        fprintf(out, "  throughput: %.2f MB/s, %.0f nodes/s "
+                "(%ld bytes, %lu nodes)\n",
+                mbps, nodesps, size, lint->benchNodes);
+        fprintf(out, "  memory: %lu allocations, %lu peak bytes "
+                "per iteration\n",
+                (unsigned long) (lint->benchAllocs / n),
+                (unsigned long) lint->benchPeak);
+    }
+
+    lint->benchAllocs = 0;
+    lint->benchPeak = 0;
+}
+
+/*
+ * benchCountNodes: count the nodes of a document tree
+ */
+static unsigned long
+benchCountNodes(xmlDocPtr doc) {
+    xmlNodePtr node = doc->children;
+    unsigned long count = 0;
+
+    while (node != NULL) {
+        count += 1;
+
+        if ((node->children != NULL) &&
+            (node->type != XML_ENTITY_REF_NODE) &&
+            (node->type != XML_DTD_NODE)) {
+            node = node->children;
+            continue;
+        }
+
+        while ((node != NULL) && (node->next == NULL)) {
+            node = node->parent;
+            if (node == (xmlNodePtr) doc)
+                node = NULL;
+        }
+        if (node != NULL)
+            node = node->next;
+    }
+
+    return(count);
+}
+
 /************************************************************************
  *									*
  *			SAX based tests					*
@@ -1214,8 +1476,16 @@ testSAX(xmllintState *lint, const char *filename) {
             return;
         }
 	xmlSchemaValidateSetFilename(vctxt, filename);
+#ifdef LIBXML_DEBUG_ENABLED
+        if (lint->appOptions & XML_LINT_SCHEMA_PROFILE)
+            xmlSchemaValidCtxtSetProfile(vctxt, 1);
+#endif
 
 	ret = xmlSchemaValidateStream(vctxt, buf, 0, lint->ctxt->sax, lint);
+#ifdef LIBXML_DEBUG_ENABLED
+        if (lint->appOptions & XML_LINT_SCHEMA_PROFILE)
+            xmlSchemaValidCtxtDumpProfile(lint->errStream, vctxt);
+#endif
 	if (lint->repeat == 1) {
 	    if (ret == 0) {
 	        if ((lint->appOptions & XML_LINT_QUIET) != XML_LINT_QUIET) {
@@ -1264,16 +1534,16 @@ static void processNode(xmllintState *lint, xmlTextReaderPtr reader) {
 	value = xmlTextReaderConstValue(reader);
 
 
-	printf("%d %d %s %d %d",
+	fprintf(lint->outStream, "%d %d %s %d %d",
 		xmlTextReaderDepth(reader),
 		type,
 		name,
 		empty,
 		xmlTextReaderHasValue(reader));
 	if (value == NULL)
-	    printf("\n");
+	    fprintf(lint->outStream, "\n");
 	else {
-	    printf(" %s\n", value);
+	    fprintf(lint->outStream, " %s\n", value);
 	}
     }
 #ifdef LIBXML_PATTERN_ENABLED
@@ -1288,7 +1558,8 @@ static void processNode(xmllintState *lint, xmlTextReaderPtr reader) {
 
 	    if (match) {
 		path = xmlGetNodePath(xmlTextReaderCurrentNode(reader));
-		printf("Node %s matches pattern %s\n", path, lint->pattern);
+		fprintf(lint->outStream, "Node %s matches pattern %s\n",
+                        path, lint->pattern);
 	    }
 	}
 	if (lint->patstream != NULL) {
@@ -1334,11 +1605,119 @@ static void processNode(xmllintState *lint, xmlTextReaderPtr reader) {
 #endif
 }
 
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_XPATH_ENABLED)
+static void
+streamXPathPrint(xmllintState *lint, xmlTextReaderPtr reader,
+                 xmlOutputBufferPtr buf, int *nbMatches) {
+    xmlNodePtr node;
+
+    *nbMatches += 1;
+
+    /* Only the subtree of a matching element is built */
+    if (xmlTextReaderNodeType(reader) == XML_READER_TYPE_ELEMENT)
+        xmlTextReaderExpand(reader);
+    node = xmlTextReaderCurrentNode(reader);
+    if (node == NULL) {
+        lint->progresult = XMLLINT_ERR_XPATH;
+        return;
+    }
+
+#ifdef LIBXML_OUTPUT_ENABLED
+    xmlNodeDumpOutput(buf, NULL, node, 0, 0, NULL);
+    xmlOutputBufferWrite(buf, 1, "\n");
+    xmlOutputBufferFlush(buf);
+#else
+    (void) buf;
+#endif
+}
+
+/*
+ * Feed the current reader node to the stream context of the
+ * --xpath expression and print the nodes which match.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+static int
+streamXPathNode(xmllintState *lint, xmlTextReaderPtr reader,
+                xmlStreamCtxtPtr stream, xmlOutputBufferPtr buf,
+                int *nbMatches) {
+    int nodeType;
+    int ret;
+
+    switch (xmlTextReaderNodeType(reader)) {
+        case XML_READER_TYPE_ELEMENT: {
+            int empty = xmlTextReaderIsEmptyElement(reader);
+
+            ret = xmlStreamPush(stream, xmlTextReaderConstLocalName(reader),
+                                xmlTextReaderConstNamespaceUri(reader));
+            if (ret < 0)
+                return(-1);
+            if (ret == 1)
+                streamXPathPrint(lint, reader, buf, nbMatches);
+
+            while (xmlTextReaderMoveToNextAttribute(reader) == 1) {
+                if (xmlTextReaderIsNamespaceDecl(reader))
+                    continue;
+                ret = xmlStreamPushAttr(stream,
+                        xmlTextReaderConstLocalName(reader),
+                        xmlTextReaderConstNamespaceUri(reader));
+                if (ret < 0)
+                    return(-1);
+                if (ret == 1)
+                    streamXPathPrint(lint, reader, buf, nbMatches);
+                if (xmlStreamPop(stream) < 0)
+                    return(-1);
+            }
+            xmlTextReaderMoveToElement(reader);
+
+            if ((empty) && (xmlStreamPop(stream) < 0))
+                return(-1);
+            return(0);
+        }
+
+        case XML_READER_TYPE_END_ELEMENT:
+            return(xmlStreamPop(stream));
+
+        case XML_READER_TYPE_TEXT:
+        case XML_READER_TYPE_WHITESPACE:
+        case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+            nodeType = XML_TEXT_NODE;
+            break;
+        case XML_READER_TYPE_CDATA:
+            nodeType = XML_CDATA_SECTION_NODE;
+            break;
+        case XML_READER_TYPE_COMMENT:
+            nodeType = XML_COMMENT_NODE;
+            break;
+        case XML_READER_TYPE_PROCESSING_INSTRUCTION:
+            nodeType = XML_PI_NODE;
+            break;
+        default:
+            return(0);
+    }
+
+    if (!xmlStreamWantsAnyNode(stream))
+        return(0);
+    ret = xmlStreamPushNode(stream, xmlTextReaderConstLocalName(reader),
+                            NULL, nodeType);
+    if (ret < 0)
+        return(-1);
+    if (ret == 1)
+        streamXPathPrint(lint, reader, buf, nbMatches);
+    return(xmlStreamPop(stream));
+}
+#endif /* LIBXML_PATTERN_ENABLED && LIBXML_XPATH_ENABLED */
+
 static void streamFile(xmllintState *lint, const char *filename) {
     xmlParserInputBufferPtr input = NULL;
     FILE *errStream = lint->errStream;
     xmlTextReaderPtr reader;
     int ret;
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_XPATH_ENABLED)
+    xmlStreamCtxtPtr xpathStream = NULL;
+    xmlOutputBufferPtr xpathBuf = NULL;
+    int nbMatches = 0;
+#endif
 
 #if HAVE_DECL_MMAP
     if (lint->appOptions & XML_LINT_MEMORY) {
@@ -1387,7 +1766,26 @@ static void streamFile(xmllintState *lint, const char *filename) {
 	}
     }
 #endif
-
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_XPATH_ENABLED)
+    if (lint->xpathpatc != NULL) {
+        xpathStream = xmlPatternGetStreamCtxt(lint->xpathpatc);
+#ifdef LIBXML_OUTPUT_ENABLED
+        xpathBuf = xmlOutputBufferCreateFile(lint->outStream, NULL);
+        if (xpathBuf == NULL) {
+            xmlFreeStreamCtxt(xpathStream);
+            xpathStream = NULL;
+        }
+#endif
+        if ((xpathStream == NULL) ||
+            (xmlStreamPush(xpathStream, NULL, NULL) < 0)) {
+            lint->progresult = XMLLINT_ERR_MEM;
+            xmlFreeStreamCtxt(xpathStream);
+            xmlOutputBufferClose(xpathBuf);
+            xmlFreeTextReader(reader);
+            return;
+        }
+    }
+#endif
 
     xmlTextReaderSetResourceLoader(reader, xmllintResourceLoader, lint);
     if (lint->maxAmpl > 0)
@@ -1398,7 +1796,10 @@ static void streamFile(xmllintState *lint, const char *filename) {
         if ((lint->appOptions & XML_LINT_TIMINGS) && (lint->repeat == 1)) {
             startTimer(lint);
         }
-        ret = xmlTextReaderRelaxNGValidate(reader, lint->relaxng);
+        if (lint->relaxngschemas != NULL)
+            ret = xmlTextReaderRelaxNGSetSchema(reader, lint->relaxngschemas);
+        else
+            ret = xmlTextReaderRelaxNGValidate(reader, lint->relaxng);
         if (ret < 0) {
             fprintf(errStream, "Relax-NG schema %s failed to compile\n",
                     lint->relaxng);
@@ -1415,7 +1816,10 @@ static void streamFile(xmllintState *lint, const char *filename) {
         if ((lint->appOptions & XML_LINT_TIMINGS) && (lint->repeat == 1)) {
             startTimer(lint);
         }
-        ret = xmlTextReaderSchemaValidate(reader, lint->schema);
+        if (lint->wxschemas != NULL)
+            ret = xmlTextReaderSetSchema(reader, lint->wxschemas);
+        else
+            ret = xmlTextReaderSchemaValidate(reader, lint->schema);
         if (ret < 0) {
             fprintf(errStream, "XSD schema %s failed to compile\n",
                     lint->schema);
@@ -1436,12 +1840,22 @@ static void streamFile(xmllintState *lint, const char *filename) {
     }
     ret = xmlTextReaderRead(reader);
     while (ret == 1) {
+        lint->benchNodes += 1;
         if ((lint->appOptions & XML_LINT_DEBUG_ENABLED)
 #ifdef LIBXML_PATTERN_ENABLED
             || (lint->patternc)
 #endif
            )
             processNode(lint, reader);
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_XPATH_ENABLED)
+        if ((xpathStream != NULL) &&
+            (streamXPathNode(lint, reader, xpathStream, xpathBuf,
+                             &nbMatches) < 0)) {
+            lint->progresult = XMLLINT_ERR_XPATH;
+            xmlFreeStreamCtxt(xpathStream);
+            xpathStream = NULL;
+        }
+#endif
         ret = xmlTextReaderRead(reader);
     }
     if ((lint->appOptions & XML_LINT_TIMINGS) && (lint->repeat == 1)) {
@@ -1490,6 +1904,23 @@ static void streamFile(xmllintState *lint, const char *filename) {
             }
         }
     }
+#endif
+#if defined(LIBXML_PATTERN_ENABLED) && defined(LIBXML_XPATH_ENABLED)
+    if (xpathStream != NULL) {
+        if ((ret == 0) && (nbMatches == 0)) {
+            lint->progresult = XMLLINT_ERR_XPATH_EMPTY;
+            if ((lint->appOptions & XML_LINT_QUIET) != XML_LINT_QUIET)
+                fprintf(errStream, "XPath set is empty\n");
+        }
+#ifndef LIBXML_OUTPUT_ENABLED
+        else if (ret == 0) {
+            fprintf(lint->outStream, "xpath returned %d nodes\n", nbMatches);
+        }
+#endif
+        xmlFreeStreamCtxt(xpathStream);
+    }
+    if (xpathBuf != NULL)
+        xmlOutputBufferClose(xpathBuf);
 #endif
     /*
      * Done, cleanup and status
@@ -1547,17 +1978,20 @@ static void walkDoc(xmllintState *lint, xmlDocPtr doc) {
             goto error;
 	}
 
-        lint->patstream = xmlPatternGetStreamCtxt(lint->patternc);
-        if (lint->patstream == NULL) {
-            lint->progresult = XMLLINT_ERR_MEM;
-            goto error;
-        }
+        /* Patterns with predicates can only be matched against nodes */
+        if (xmlPatternStreamable(lint->patternc) == 1) {
+            lint->patstream = xmlPatternGetStreamCtxt(lint->patternc);
+            if (lint->patstream == NULL) {
+                lint->progresult = XMLLINT_ERR_MEM;
+                goto error;
+            }
 
-        ret = xmlStreamPush(lint->patstream, NULL, NULL);
-        if (ret < 0) {
-            fprintf(errStream, "xmlStreamPush() failure\n");
-            lint->progresult = XMLLINT_ERR_MEM;
-            goto error;
+            ret = xmlStreamPush(lint->patstream, NULL, NULL);
+            if (ret < 0) {
+                fprintf(errStream, "xmlStreamPush() failure\n");
+                lint->progresult = XMLLINT_ERR_MEM;
+                goto error;
+            }
         }
     }
 #endif /* LIBXML_PATTERN_ENABLED */
@@ -1626,7 +2060,7 @@ doXPathDump(xmllintState *lint, xmlXPathObjectPtr cur) {
                 }
                 break;
             }
-            buf = xmlOutputBufferCreateFile(stdout, NULL);
+            buf = xmlOutputBufferCreateFile(lint->outStream, NULL);
             if (buf == NULL) {
                 lint->progresult = XMLLINT_ERR_MEM;
                 return;
@@ -1638,32 +2072,33 @@ doXPathDump(xmllintState *lint, xmlXPathObjectPtr cur) {
             }
             xmlOutputBufferClose(buf);
 #else
-            printf("xpath returned %d nodes\n", cur->nodesetval->nodeNr);
+            fprintf(lint->outStream, "xpath returned %d nodes\n",
+                    cur->nodesetval->nodeNr);
 #endif
 	    break;
         }
         case XPATH_BOOLEAN:
-	    if (cur->boolval) printf("true\n");
-	    else printf("false\n");
+	    if (cur->boolval) fprintf(lint->outStream, "true\n");
+	    else fprintf(lint->outStream, "false\n");
 	    break;
         case XPATH_NUMBER:
 	    switch (xmlXPathIsInf(cur->floatval)) {
 	    case 1:
-		printf("Infinity\n");
+		fprintf(lint->outStream, "Infinity\n");
 		break;
 	    case -1:
-		printf("-Infinity\n");
+		fprintf(lint->outStream, "-Infinity\n");
 		break;
 	    default:
 		if (xmlXPathIsNaN(cur->floatval)) {
-		    printf("NaN\n");
+		    fprintf(lint->outStream, "NaN\n");
 		} else {
-		    printf("%0g\n", cur->floatval);
+		    fprintf(lint->outStream, "%0g\n", cur->floatval);
 		}
 	    }
 	    break;
         case XPATH_STRING:
-	    printf("%s\n", (const char *) cur->stringval);
+	    fprintf(lint->outStream, "%s\n", (const char *) cur->stringval);
 	    break;
         case XPATH_UNDEFINED:
 	    fprintf(lint->errStream, "XPath Object is uninitialized\n");
@@ -1688,6 +2123,11 @@ doXPathQuery(xmllintState *lint, xmlDocPtr doc, const char *query) {
         goto error;
     }
 
+#ifdef LIBXML_DEBUG_ENABLED
+    if (lint->appOptions & XML_LINT_XPATH_PROFILE)
+        ctxt->flags |= XML_XPATH_PROFILE;
+#endif
+
     comp = xmlXPathCtxtCompile(ctxt, BAD_CAST query);
     if (comp == NULL) {
         fprintf(lint->errStream, "XPath compilation failure\n");
@@ -1697,8 +2137,8 @@ doXPathQuery(xmllintState *lint, xmlDocPtr doc, const char *query) {
 
 #ifdef LIBXML_DEBUG_ENABLED
     if (lint->appOptions & XML_LINT_DEBUG_ENABLED) {
-        xmlXPathDebugDumpCompExpr(stdout, comp, 0);
-        printf("\n");
+        xmlXPathDebugDumpCompExpr(lint->outStream, comp, 0);
+        fprintf(lint->outStream, "\n");
     }
 #endif
 
@@ -1712,6 +2152,11 @@ doXPathQuery(xmllintState *lint, xmlDocPtr doc, const char *query) {
 
     doXPathDump(lint, res);
 
+#ifdef LIBXML_DEBUG_ENABLED
+    if (lint->appOptions & XML_LINT_XPATH_PROFILE)
+        xmlXPathDebugDumpProfile(lint->errStream, comp, 0);
+#endif
+
 error:
     xmlXPathFreeObject(res);
     xmlXPathFreeCompExpr(comp);
@@ -1784,6 +2229,28 @@ parseFile(xmllintState *lint, const char *filename) {
     return(doc);
 }
 
+#ifdef LIBXML_OUTPUT_ENABLED
+/*
+ * Write serialized output to the output stream of the current file.
+ * Standard output is written unbuffered as before.
+ */
+static int
+xmllintWriteOutput(xmllintState *lint, const void *data, int size) {
+    if (lint->outStream == stdout)
+        return(write(1, data, size) == -1 ? -1 : 0);
+    if (fwrite(data, 1, size, lint->outStream) != (size_t) size)
+        return(-1);
+    return(0);
+}
+
+static int
+xmllintWriteCallback(void *ctxt, const char *buffer, int len) {
+    if (fwrite(buffer, 1, len, (FILE *) ctxt) != (size_t) len)
+        return(-1);
+    return(len);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
 static void
 parseAndPrintFile(xmllintState *lint, const char *filename) {
     FILE *errStream = lint->errStream;
@@ -1955,7 +2422,7 @@ parseAndPrintFile(xmllintState *lint, const char *filename) {
 
 		size = xmlC14NDocDumpMemory(doc, NULL, XML_C14N_1_0, NULL, 1, &result);
 		if (size >= 0) {
-		    if (write(1, result, size) == -1) {
+		    if (xmllintWriteOutput(lint, result, size) < 0) {
 		        fprintf(errStream, "Can't write data\n");
 		    }
 		    xmlFree(result);
@@ -1969,7 +2436,7 @@ parseAndPrintFile(xmllintState *lint, const char *filename) {
 
 		size = xmlC14NDocDumpMemory(doc, NULL, XML_C14N_1_1, NULL, 1, &result);
 		if (size >= 0) {
-		    if (write(1, result, size) == -1) {
+		    if (xmllintWriteOutput(lint, result, size) < 0) {
 		        fprintf(errStream, "Can't write data\n");
 		    }
 		    xmlFree(result);
@@ -1983,7 +2450,7 @@ parseAndPrintFile(xmllintState *lint, const char *filename) {
 
 		size = xmlC14NDocDumpMemory(doc, NULL, XML_C14N_EXCLUSIVE_1_0, NULL, 1, &result);
 		if (size >= 0) {
-		    if (write(1, result, size) == -1) {
+		    if (xmllintWriteOutput(lint, result, size) < 0) {
 		        fprintf(errStream, "Can't write data\n");
 		    }
 		    xmlFree(result);
@@ -2012,12 +2479,16 @@ parseAndPrintFile(xmllintState *lint, const char *filename) {
                     saveOpts |= XML_SAVE_AS_XML;
 #endif
 
-		if (lint->output == NULL)
+		if (lint->output != NULL)
+		    ctxt = xmlSaveToFilename(lint->output, lint->encoding,
+                                             saveOpts);
+		else if (lint->outStream == stdout)
 		    ctxt = xmlSaveToFd(STDOUT_FILENO, lint->encoding,
                                        saveOpts);
 		else
-		    ctxt = xmlSaveToFilename(lint->output, lint->encoding,
-                                             saveOpts);
+		    ctxt = xmlSaveToIO(xmllintWriteCallback, NULL,
+                                       lint->outStream, lint->encoding,
+                                       saveOpts);
 
 		if (ctxt != NULL) {
                     if (lint->indentString != NULL)
@@ -2040,7 +2511,7 @@ parseAndPrintFile(xmllintState *lint, const char *filename) {
 	} else {
 	    FILE *out;
 	    if (lint->output == NULL)
-	        out = stdout;
+	        out = lint->outStream;
 	    else {
 		out = fopen(lint->output, "wb");
 	    }
@@ -2229,7 +2700,15 @@ parseAndPrintFile(xmllintState *lint, const char *filename) {
             xmlFreeDoc(doc);
             return;
         }
+#ifdef LIBXML_DEBUG_ENABLED
+        if (lint->appOptions & XML_LINT_SCHEMA_PROFILE)
+            xmlSchemaValidCtxtSetProfile(ctxt, 1);
+#endif
 	ret = xmlSchemaValidateDoc(ctxt, doc);
+#ifdef LIBXML_DEBUG_ENABLED
+        if (lint->appOptions & XML_LINT_SCHEMA_PROFILE)
+            xmlSchemaValidCtxtDumpProfile(errStream, ctxt);
+#endif
 	if (ret == 0) {
 	    if ((lint->appOptions & XML_LINT_QUIET) != XML_LINT_QUIET) {
 	        fprintf(errStream, "%s validates\n", filename);
@@ -2253,6 +2732,9 @@ parseAndPrintFile(xmllintState *lint, const char *filename) {
     goto done;
 
 done:
+    if (lint->benchmark > 0)
+        lint->benchNodes = benchCountNodes(doc);
+
     /*
      * free it.
      */
@@ -2300,6 +2782,7 @@ static void showVersion(FILE *errStream, const char *name) {
     if (xmlHasFeature(XML_WITH_MODULES)) fprintf(errStream, "Modules ");
     if (xmlHasFeature(XML_WITH_DEBUG)) fprintf(errStream, "Debug ");
     if (xmlHasFeature(XML_WITH_ZLIB)) fprintf(errStream, "Zlib ");
+    if (xmlHasFeature(XML_WITH_ZSTD)) fprintf(errStream, "Zstd ");
     fprintf(errStream, "\n");
 }
 
@@ -2334,6 +2817,10 @@ static void usage(FILE *f, const char *name) {
     fprintf(f, "\t--quiet : be quiet when succeeded\n");
     fprintf(f, "\t--timing : print some timings\n");
     fprintf(f, "\t--repeat : repeat 100 times, for timing or profiling\n");
+    fprintf(f, "\t--benchmark N : run N timed iterations and report statistics\n");
+    fprintf(f, "\t--warmup N : untimed iterations before --benchmark (default 1)\n");
+    fprintf(f, "\t--benchmark-json : print the --benchmark report as JSON\n");
+    fprintf(f, "\t--jobs N : process input files on N threads, output in input order\n");
     fprintf(f, "\t--dropdtd : remove the DOCTYPE of the input docs\n");
 #ifdef LIBXML_HTML_ENABLED
     fprintf(f, "\t--html : use the HTML parser\n");
@@ -2349,6 +2836,7 @@ static void usage(FILE *f, const char *name) {
     fprintf(f, "\t--memory : parse from memory\n");
 #endif
     fprintf(f, "\t--maxmem nbbytes : limits memory allocation to nbbytes bytes\n");
+    fprintf(f, "\t--alloc-profile : print memory allocations by call site\n");
     fprintf(f, "\t--nowarning : do not emit warnings from parser/validator\n");
     fprintf(f, "\t--noblanks : drop (ignorable?) blanks spaces\n");
     fprintf(f, "\t--nocdata : replace cdata section with text nodes\n");
@@ -2399,6 +2887,9 @@ static void usage(FILE *f, const char *name) {
 #endif
 #ifdef LIBXML_SCHEMAS_ENABLED
     fprintf(f, "\t--schema schema : do validation against the WXS schema\n");
+#ifdef LIBXML_DEBUG_ENABLED
+    fprintf(f, "\t--timing-detail : print a profile of --schema validation\n");
+#endif
 #endif
 #ifdef LIBXML_SCHEMATRON_ENABLED
     fprintf(f, "\t--schematron schema : do validation against a schematron\n");
@@ -2410,6 +2901,12 @@ static void usage(FILE *f, const char *name) {
     fprintf(f, "\t--oldxml10: use XML-1.0 parsing rules before the 5th edition\n");
 #ifdef LIBXML_XPATH_ENABLED
     fprintf(f, "\t--xpath expr: evaluate the XPath expression, imply --noout\n");
+#if defined(LIBXML_READER_ENABLED) && defined(LIBXML_PATTERN_ENABLED)
+    fprintf(f, "\t         with --stream, print matches of a streamable expression\n");
+#endif
+#ifdef LIBXML_DEBUG_ENABLED
+    fprintf(f, "\t--xpath-profile : print evaluation counters of the --xpath expression\n");
+#endif
 #endif
     fprintf(f, "\t--max-ampl value: set maximum amplification factor\n");
 
@@ -2443,6 +2940,12 @@ skipArgs(const char *arg) {
         (!strcmp(arg, "--path")) ||
         (!strcmp(arg, "-maxmem")) ||
         (!strcmp(arg, "--maxmem")) ||
+        (!strcmp(arg, "-benchmark")) ||
+        (!strcmp(arg, "--benchmark")) ||
+        (!strcmp(arg, "-warmup")) ||
+        (!strcmp(arg, "--warmup")) ||
+        (!strcmp(arg, "-jobs")) ||
+        (!strcmp(arg, "--jobs")) ||
 #ifdef LIBXML_OUTPUT_ENABLED
         (!strcmp(arg, "-o")) ||
         (!strcmp(arg, "-output")) ||
@@ -2491,7 +2994,10 @@ static void
 xmllintInit(xmllintState *lint) {
     memset(lint, 0, sizeof(*lint));
 
+    lint->outStream = stdout;
     lint->repeat = 1;
+    lint->jobs = 1;
+    lint->warmup = 1;
     lint->progresult = XMLLINT_RETURN_OK;
     lint->parseOptions = XML_PARSE_COMPACT | XML_PARSE_BIG_LINES;
 #ifdef LIBXML_HTML_ENABLED
@@ -2628,6 +3134,9 @@ xmllintParseOptions(xmllintState *lint, int argc, const char **argv) {
         } else if ((!strcmp(argv[i], "-timing")) ||
                    (!strcmp(argv[i], "--timing"))) {
             lint->appOptions |= XML_LINT_TIMINGS;
+        } else if ((!strcmp(argv[i], "-alloc-profile")) ||
+                   (!strcmp(argv[i], "--alloc-profile"))) {
+            lint->appOptions |= XML_LINT_ALLOC_PROFILE;
         } else if ((!strcmp(argv[i], "-auto")) ||
                    (!strcmp(argv[i], "--auto"))) {
             lint->appOptions |= XML_LINT_GENERATE;
@@ -2641,6 +3150,42 @@ xmllintParseOptions(xmllintState *lint, int argc, const char **argv) {
             else
                 lint->repeat = 100;
 #endif
+        } else if ((!strcmp(argv[i], "-benchmark")) ||
+                   (!strcmp(argv[i], "--benchmark"))) {
+            i++;
+            if (i >= argc) {
+                fprintf(errStream, "benchmark: missing integer value\n");
+                return(XMLLINT_ERR_UNCLASS);
+            }
+            if (parseInteger(&val, errStream, "benchmark", argv[i],
+                             1, 1000000) < 0)
+                return(XMLLINT_ERR_UNCLASS);
+            lint->benchmark = val;
+        } else if ((!strcmp(argv[i], "-warmup")) ||
+                   (!strcmp(argv[i], "--warmup"))) {
+            i++;
+            if (i >= argc) {
+                fprintf(errStream, "warmup: missing integer value\n");
+                return(XMLLINT_ERR_UNCLASS);
+            }
+            if (parseInteger(&val, errStream, "warmup", argv[i],
+                             0, 1000000) < 0)
+                return(XMLLINT_ERR_UNCLASS);
+            lint->warmup = val;
+        } else if ((!strcmp(argv[i], "-jobs")) ||
+                   (!strcmp(argv[i], "--jobs"))) {
+            i++;
+            if (i >= argc) {
+                fprintf(errStream, "jobs: missing integer value\n");
+                return(XMLLINT_ERR_UNCLASS);
+            }
+            if (parseInteger(&val, errStream, "jobs", argv[i],
+                             1, 64) < 0)
+                return(XMLLINT_ERR_UNCLASS);
+            lint->jobs = val;
+        } else if ((!strcmp(argv[i], "-benchmark-json")) ||
+                   (!strcmp(argv[i], "--benchmark-json"))) {
+            lint->appOptions |= XML_LINT_BENCHMARK_JSON;
 #ifdef LIBXML_PUSH_ENABLED
         } else if ((!strcmp(argv[i], "-push")) ||
                    (!strcmp(argv[i], "--push"))) {
@@ -2777,6 +3322,11 @@ xmllintParseOptions(xmllintState *lint, int argc, const char **argv) {
             i++;
             lint->schema = argv[i];
             lint->parseOptions |= XML_PARSE_NOENT;
+#ifdef LIBXML_DEBUG_ENABLED
+        } else if ((!strcmp(argv[i], "-timing-detail")) ||
+                   (!strcmp(argv[i], "--timing-detail"))) {
+            lint->appOptions |= XML_LINT_SCHEMA_PROFILE;
+#endif
 #endif
 #ifdef LIBXML_SCHEMATRON_ENABLED
         } else if ((!strcmp(argv[i], "-schematron")) ||
@@ -2807,6 +3357,11 @@ xmllintParseOptions(xmllintState *lint, int argc, const char **argv) {
             i++;
             lint->noout++;
             lint->xpathquery = argv[i];
+#ifdef LIBXML_DEBUG_ENABLED
+        } else if ((!strcmp(argv[i], "-xpath-profile")) ||
+                   (!strcmp(argv[i], "--xpath-profile"))) {
+            lint->appOptions |= XML_LINT_XPATH_PROFILE;
+#endif
 #endif
         } else if ((!strcmp(argv[i], "-oldxml10")) ||
                    (!strcmp(argv[i], "--oldxml10"))) {
@@ -2829,8 +3384,49 @@ xmllintParseOptions(xmllintState *lint, int argc, const char **argv) {
         }
     }
 
-    if (lint->appOptions & XML_LINT_NAVIGATING_SHELL)
+    if (lint->appOptions & XML_LINT_NAVIGATING_SHELL) {
         lint->repeat = 1;
+        lint->benchmark = 0;
+    }
+
+    if (lint->benchmark > 0) {
+        if (lint->repeat > 1)
+            xmllintOptWarnNoSupport(errStream, "--benchmark", "--repeat");
+        lint->repeat = lint->warmup + lint->benchmark;
+    }
+
+    if (lint->jobs > 1) {
+        const char *nosupp = NULL;
+
+        /*
+         * Workers capture their output per file, which rules out
+         * options writing to shared destinations or global state.
+         */
+        if (lint->appOptions & XML_LINT_NAVIGATING_SHELL)
+            nosupp = "--shell";
+        else if (lint->appOptions & XML_LINT_SAX_ENABLED)
+            nosupp = "--sax";
+        else if (lint->appOptions & XML_LINT_MEMORY)
+            nosupp = "--memory";
+        else if (lint->maxmem != 0)
+            nosupp = "--maxmem";
+        else if (lint->benchmark > 0)
+            nosupp = "--benchmark";
+#ifdef LIBXML_OUTPUT_ENABLED
+        else if ((lint->output != NULL) && (!lint->noout))
+            nosupp = "--output";
+#endif
+#ifdef LIBXML_ZLIB_ENABLED
+        else if ((lint->appOptions & XML_LINT_ZLIB_COMPRESSION) &&
+                 (!lint->noout))
+            nosupp = "--compress";
+#endif
+
+        if (nosupp != NULL) {
+            xmllintOptWarnNoSupport(errStream, "--jobs", nosupp);
+            lint->jobs = 1;
+        }
+    }
 
 #ifdef LIBXML_READER_ENABLED
     if (lint->appOptions & XML_LINT_USE_STREAMING) {
@@ -2872,7 +3468,7 @@ xmllintParseOptions(xmllintState *lint, int argc, const char **argv) {
         if (lint->appOptions & XML_LINT_COPY_ENABLED)
             xmllintOptWarnNoSupport(errStream, specialMode, "--copy");
 #ifdef LIBXML_XPATH_ENABLED
-        if (lint->xpathquery != NULL)
+        if ((lint->xpathquery != NULL) && (strcmp(specialMode, "--stream") != 0))
             xmllintOptWarnNoSupport(errStream, specialMode, "--xpath");
 #endif
 #ifdef LIBXML_READER_ENABLED
@@ -2967,11 +3563,246 @@ xmllintParseOptions(xmllintState *lint, int argc, const char **argv) {
     return(XMLLINT_RETURN_OK);
 }
 
+/*
+ * Run the selected pipeline on one input, lint->repeat times.
+ *
+ * Returns -1 if processing must stop because of a fatal error.
+ */
+static int
+xmllintProcessFile(xmllintState *lint, const char *filename) {
+    int j;
+
+#ifdef LIBXML_READER_ENABLED
+    if (lint->appOptions & XML_LINT_USE_STREAMING) {
+        for (j = 0; j < lint->repeat; j++) {
+            benchStart(lint);
+            streamFile(lint, filename);
+            benchStop(lint, j);
+        }
+    } else
+#endif /* LIBXML_READER_ENABLED */
+    {
+        xmlParserCtxtPtr ctxt;
+
+#ifdef LIBXML_HTML_ENABLED
+        if (lint->appOptions & XML_LINT_HTML_ENABLED) {
+#ifdef LIBXML_PUSH_ENABLED
+            if (lint->appOptions & XML_LINT_PUSH_ENABLED) {
+                ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0,
+                                                filename,
+                                                XML_CHAR_ENCODING_NONE);
+            } else
+#endif /* LIBXML_PUSH_ENABLED */
+            {
+                ctxt = htmlNewParserCtxt();
+            }
+            htmlCtxtUseOptions(ctxt, lint->htmlOptions);
+        } else
+#endif /* LIBXML_HTML_ENABLED */
+        {
+#ifdef LIBXML_PUSH_ENABLED
+            if (lint->appOptions & XML_LINT_PUSH_ENABLED) {
+                ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0,
+                                               filename);
+            } else
+#endif /* LIBXML_PUSH_ENABLED */
+            {
+                ctxt = xmlNewParserCtxt();
+            }
+            xmlCtxtUseOptions(ctxt, lint->parseOptions);
+        }
+        if (ctxt == NULL) {
+            lint->progresult = XMLLINT_ERR_MEM;
+            return(-1);
+        }
+
+        if (lint->appOptions & XML_LINT_SAX_ENABLED) {
+            const xmlSAXHandler *handler;
+
+            if (lint->noout) {
+                handler = &emptySAXHandler;
+#ifdef LIBXML_SAX1_ENABLED
+            } else if (lint->parseOptions & XML_PARSE_SAX1) {
+                handler = &debugSAXHandler;
+#endif
+            } else {
+                handler = &debugSAX2Handler;
+            }
+
+            *ctxt->sax = *handler;
+            ctxt->userData = lint;
+        }
+
+        xmlCtxtSetResourceLoader(ctxt, xmllintResourceLoader, lint);
+        if (lint->maxAmpl > 0)
+            xmlCtxtSetMaxAmplification(ctxt, lint->maxAmpl);
+
+        lint->ctxt = ctxt;
+
+        for (j = 0; j < lint->repeat; j++) {
+            if (j > 0) {
+#ifdef LIBXML_PUSH_ENABLED
+                if (lint->appOptions & XML_LINT_PUSH_ENABLED) {
+                    xmlCtxtResetPush(ctxt, NULL, 0, NULL, NULL);
+                } else
+#endif
+                {
+                    xmlCtxtReset(ctxt);
+                }
+            }
+
+            benchStart(lint);
+            if (lint->appOptions & XML_LINT_SAX_ENABLED) {
+                testSAX(lint, filename);
+            } else {
+                parseAndPrintFile(lint, filename);
+            }
+            benchStop(lint, j);
+        }
+
+        xmlFreeParserCtxt(ctxt);
+        lint->ctxt = NULL;
+    }
+
+    return(0);
+}
+
+/************************************************************************
+ *									*
+ *			Parallel processing				*
+ *									*
+ ************************************************************************/
+
+/* Number of files in flight per worker */
+#define XMLLINT_JOBS_WINDOW 4
+
+typedef struct {
+    xmllintState lint;
+    const char *filename;
+    int fatal;
+} xmllintJob;
+
+static void
+xmllintRunJob(void *arg) {
+    xmllintJob *job = arg;
+    xmlGenericErrorFunc oldHandler = xmlGenericError;
+    void *oldCtxt = xmlGenericErrorContext;
+
+    /*
+     * Library errors go to the thread-local generic error handler,
+     * redirect them to the captured error stream of the file.
+     */
+    xmlSetGenericErrorFunc(job->lint.errStream, NULL);
+    if (xmllintProcessFile(&job->lint, job->filename) < 0)
+        job->fatal = 1;
+    xmlSetGenericErrorFunc(oldCtxt, oldHandler);
+}
+
+static void
+xmllintCopyStream(FILE *from, FILE *to) {
+    char buf[4096];
+    size_t len;
+
+    rewind(from);
+    while ((len = fread(buf, 1, sizeof(buf), from)) > 0)
+        fwrite(buf, 1, len, to);
+    fflush(to);
+}
+
+/*
+ * Process the input files on lint->jobs threads of the library's
+ * thread pool. Compiled schemas and patterns are shared read-only,
+ * every file gets a private copy of the state with its output and
+ * errors captured in temporary files. These are copied to the real
+ * streams in input order once a window of files has finished.
+ *
+ * Returns the number of files processed or -1 after a fatal error.
+ */
+static int
+xmllintRunJobs(xmllintState *lint, int argc, const char **argv) {
+    xmllintJob *jobs;
+    xmlTaskGroup *group;
+    int window = lint->jobs * XMLLINT_JOBS_WINDOW;
+    int files = 0, fatal = 0;
+    int i, nb, k;
+
+    jobs = xmlMalloc(window * sizeof(jobs[0]));
+    group = xmlNewTaskGroup();
+    if ((jobs == NULL) || (group == NULL) ||
+        (xmlThreadPoolSetSize(lint->jobs - 1) < 0)) {
+        xmlFree(jobs);
+        xmlFreeTaskGroup(group);
+        lint->progresult = XMLLINT_ERR_MEM;
+        return(-1);
+    }
+
+    i = 1;
+    while ((i < argc) && (!fatal)) {
+        nb = 0;
+        for (; (i < argc) && (nb < window); i++) {
+            const char *filename = argv[i];
+            xmllintJob *job = &jobs[nb];
+
+            if ((filename[0] == '-') && (strcmp(filename, "-") != 0)) {
+                i += skipArgs(filename);
+                continue;
+            }
+
+            job->lint = *lint;
+            job->lint.ctxt = NULL;
+            job->lint.progresult = XMLLINT_RETURN_OK;
+            job->lint.outStream = tmpfile();
+            job->lint.errStream = tmpfile();
+            job->filename = filename;
+            job->fatal = 0;
+            if ((job->lint.outStream == NULL) ||
+                (job->lint.errStream == NULL)) {
+                fprintf(lint->errStream,
+                        "Failed to create temporary file for %s\n",
+                        filename);
+                if (job->lint.outStream != NULL)
+                    fclose(job->lint.outStream);
+                if (job->lint.errStream != NULL)
+                    fclose(job->lint.errStream);
+                lint->progresult = XMLLINT_ERR_UNCLASS;
+                fatal = 1;
+                break;
+            }
+            nb++;
+
+            if (xmlTaskGroupSubmit(group, xmllintRunJob, job) < 0)
+                xmllintRunJob(job);
+        }
+
+        xmlTaskGroupJoin(group);
+
+        for (k = 0; k < nb; k++) {
+            xmllintJob *job = &jobs[k];
+
+            xmllintCopyStream(job->lint.outStream, stdout);
+            xmllintCopyStream(job->lint.errStream, lint->errStream);
+            fclose(job->lint.outStream);
+            fclose(job->lint.errStream);
+
+            if (job->lint.progresult != XMLLINT_RETURN_OK)
+                lint->progresult = job->lint.progresult;
+            if (job->fatal)
+                fatal = 1;
+            files += 1;
+        }
+    }
+
+    xmlFreeTaskGroup(group);
+    xmlFree(jobs);
+
+    return(fatal ? -1 : files);
+}
+
 int
 xmllintMain(int argc, const char **argv, FILE *errStream,
             xmlResourceLoader loader) {
     xmllintState state, *lint;
-    int i, j, res;
+    int i, res;
     int files = 0;
 
 #ifdef _WIN32
@@ -2999,6 +3830,16 @@ xmllintMain(int argc, const char **argv, FILE *errStream,
         xmllintMaxmemReached = 0;
         xmllintOom = 0;
         xmlMemSetup(myFreeFunc, myMallocFunc, myReallocFunc, myStrdupFunc);
+    } else if (lint->appOptions & XML_LINT_ALLOC_PROFILE) {
+        xmlMemSetup(xmlMemFree, xmlMemMalloc, xmlMemRealloc, xmlMemoryStrdup);
+    } else if (lint->benchmark > 0) {
+        xmlMemSetup(xmlMemFree, benchMallocFunc, benchReallocFunc,
+                    benchStrdupFunc);
+    }
+    if ((lint->appOptions & XML_LINT_ALLOC_PROFILE) &&
+        (xmlMemProfileStart() < 0)) {
+        fprintf(errStream, "Failed to start allocation profile\n");
+        return(XMLLINT_ERR_MEM);
     }
 
     LIBXML_TEST_VERSION
@@ -3060,9 +3901,14 @@ xmllintMain(int argc, const char **argv, FILE *errStream,
 #endif
 
 #ifdef LIBXML_RELAXNG_ENABLED
+    /*
+     * With --stream, the schemas are compiled for every file unless
+     * they are shared between jobs.
+     */
     if ((lint->relaxng != NULL) && ((lint->appOptions & XML_LINT_SAX_ENABLED) != XML_LINT_SAX_ENABLED)
 #ifdef LIBXML_READER_ENABLED
-        && ((lint->appOptions & XML_LINT_USE_STREAMING) != XML_LINT_USE_STREAMING)
+        && (((lint->appOptions & XML_LINT_USE_STREAMING) != XML_LINT_USE_STREAMING) ||
+            (lint->jobs > 1))
 #endif /* LIBXML_READER_ENABLED */
 	) {
 	xmlRelaxNGParserCtxtPtr ctxt;
@@ -3095,7 +3941,8 @@ xmllintMain(int argc, const char **argv, FILE *errStream,
 #ifdef LIBXML_SCHEMAS_ENABLED
     if ((lint->schema != NULL)
 #ifdef LIBXML_READER_ENABLED
-        && ((lint->appOptions& XML_LINT_USE_STREAMING) != XML_LINT_USE_STREAMING)
+        && (((lint->appOptions& XML_LINT_USE_STREAMING) != XML_LINT_USE_STREAMING) ||
+            (lint->jobs > 1))
 #endif
 	) {
 	xmlSchemaParserCtxtPtr ctxt;
@@ -3140,145 +3987,101 @@ xmllintMain(int argc, const char **argv, FILE *errStream,
     }
 #endif /* LIBXML_READER_ENABLED && LIBXML_PATTERN_ENABLED */
 
+#if defined(LIBXML_READER_ENABLED) && defined(LIBXML_PATTERN_ENABLED) && \
+    defined(LIBXML_XPATH_ENABLED)
+    if ((lint->xpathquery != NULL) &&
+        (lint->appOptions & XML_LINT_USE_STREAMING) &&
+        ((lint->appOptions & XML_LINT_SAX_ENABLED) == 0)) {
+        res = xmlPatternCompileSafe(BAD_CAST lint->xpathquery, NULL,
+                                    XML_PATTERN_XPATH, NULL,
+                                    &lint->xpathpatc);
+        if ((lint->xpathpatc == NULL) ||
+            (xmlPatternStreamable(lint->xpathpatc) != 1)) {
+            if (res < 0) {
+                lint->progresult = XMLLINT_ERR_MEM;
+            } else {
+                fprintf(errStream, "XPath expression %s can't be streamed\n",
+                        lint->xpathquery);
+                lint->progresult = XMLLINT_ERR_XPATH;
+            }
+            goto error;
+        }
+    }
+#endif
+
+    if (lint->benchmark > 0) {
+        /* Not allocated with xmlMalloc to keep the statistics clean */
+        lint->benchTimes = malloc(lint->benchmark * sizeof(double));
+        if (lint->benchTimes == NULL) {
+            lint->progresult = XMLLINT_ERR_MEM;
+            goto error;
+        }
+    }
+
     /*
      * The main loop over input documents
      */
-    for (i = 1; i < argc ; i++) {
-        const char *filename = argv[i];
+    if (lint->jobs > 1) {
+        files = xmllintRunJobs(lint, argc, argv);
+        if (files < 0)
+            goto error;
+    } else {
+        for (i = 1; i < argc ; i++) {
+            const char *filename = argv[i];
 #if HAVE_DECL_MMAP
-        int memoryFd = -1;
+            int memoryFd = -1;
 #endif
 
-	if ((filename[0] == '-') && (strcmp(filename, "-") != 0)) {
-            i += skipArgs(filename);
-            continue;
-        }
-
-#if HAVE_DECL_MMAP
-        if (lint->appOptions & XML_LINT_MEMORY) {
-            struct stat info;
-            if (stat(filename, &info) < 0) {
-                lint->progresult = XMLLINT_ERR_RDFILE;
-                break;
+            if ((filename[0] == '-') && (strcmp(filename, "-") != 0)) {
+                i += skipArgs(filename);
+                continue;
             }
-            memoryFd = open(filename, O_RDONLY);
-            if (memoryFd < 0) {
-                lint->progresult = XMLLINT_ERR_RDFILE;
-                break;
-            }
-            lint->memoryData = mmap(NULL, info.st_size, PROT_READ,
-                                    MAP_SHARED, memoryFd, 0);
-            if (lint->memoryData == (void *) MAP_FAILED) {
-                close(memoryFd);
-                fprintf(errStream, "mmap failure for file %s\n", filename);
-                lint->progresult = XMLLINT_ERR_RDFILE;
-                break;
-            }
-            lint->memorySize = info.st_size;
-        }
-#endif /* HAVE_DECL_MMAP */
-
-	if ((lint->appOptions & XML_LINT_TIMINGS) && (lint->repeat > 1))
-	    startTimer(lint);
 
-#ifdef LIBXML_READER_ENABLED
-        if (lint->appOptions & XML_LINT_USE_STREAMING) {
-            for (j = 0; j < lint->repeat; j++)
-                streamFile(lint, filename);
-        } else
-#endif /* LIBXML_READER_ENABLED */
-        {
-            xmlParserCtxtPtr ctxt;
-
-#ifdef LIBXML_HTML_ENABLED
-            if (lint->appOptions & XML_LINT_HTML_ENABLED) {
-#ifdef LIBXML_PUSH_ENABLED
-                if (lint->appOptions & XML_LINT_PUSH_ENABLED) {
-                    ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0,
-                                                    filename,
-                                                    XML_CHAR_ENCODING_NONE);
-                } else
-#endif /* LIBXML_PUSH_ENABLED */
-                {
-                    ctxt = htmlNewParserCtxt();
+#if HAVE_DECL_MMAP
+            if (lint->appOptions & XML_LINT_MEMORY) {
+                struct stat info;
+                if (stat(filename, &info) < 0) {
+                    lint->progresult = XMLLINT_ERR_RDFILE;
+                    break;
                 }
-                htmlCtxtUseOptions(ctxt, lint->htmlOptions);
-            } else
-#endif /* LIBXML_HTML_ENABLED */
-            {
-#ifdef LIBXML_PUSH_ENABLED
-                if (lint->appOptions & XML_LINT_PUSH_ENABLED) {
-                    ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0,
-                                                   filename);
-                } else
-#endif /* LIBXML_PUSH_ENABLED */
-                {
-                    ctxt = xmlNewParserCtxt();
+                memoryFd = open(filename, O_RDONLY);
+                if (memoryFd < 0) {
+                    lint->progresult = XMLLINT_ERR_RDFILE;
+                    break;
                 }
-                xmlCtxtUseOptions(ctxt, lint->parseOptions);
-            }
-            if (ctxt == NULL) {
-                lint->progresult = XMLLINT_ERR_MEM;
-                goto error;
-            }
-
-            if (lint->appOptions & XML_LINT_SAX_ENABLED) {
-                const xmlSAXHandler *handler;
-
-                if (lint->noout) {
-                    handler = &emptySAXHandler;
-#ifdef LIBXML_SAX1_ENABLED
-                } else if (lint->parseOptions & XML_PARSE_SAX1) {
-                    handler = &debugSAXHandler;
-#endif
-                } else {
-                    handler = &debugSAX2Handler;
+                lint->memoryData = mmap(NULL, info.st_size, PROT_READ,
+                                        MAP_SHARED, memoryFd, 0);
+                if (lint->memoryData == (void *) MAP_FAILED) {
+                    close(memoryFd);
+                    fprintf(errStream, "mmap failure for file %s\n", filename);
+                    lint->progresult = XMLLINT_ERR_RDFILE;
+                    break;
                 }
-
-                *ctxt->sax = *handler;
-                ctxt->userData = lint;
+                lint->memorySize = info.st_size;
             }
+#endif /* HAVE_DECL_MMAP */
 
-            xmlCtxtSetResourceLoader(ctxt, xmllintResourceLoader, lint);
-            if (lint->maxAmpl > 0)
-                xmlCtxtSetMaxAmplification(ctxt, lint->maxAmpl);
-
-            lint->ctxt = ctxt;
+            if ((lint->appOptions & XML_LINT_TIMINGS) && (lint->repeat > 1))
+                startTimer(lint);
 
-            for (j = 0; j < lint->repeat; j++) {
-                if (j > 0) {
-#ifdef LIBXML_PUSH_ENABLED
-                    if (lint->appOptions & XML_LINT_PUSH_ENABLED) {
-                        xmlCtxtResetPush(ctxt, NULL, 0, NULL, NULL);
-                    } else
-#endif
-                    {
-                        xmlCtxtReset(ctxt);
-                    }
-                }
+            if (xmllintProcessFile(lint, filename) < 0)
+                goto error;
 
-                if (lint->appOptions & XML_LINT_SAX_ENABLED) {
-                    testSAX(lint, filename);
-                } else {
-                    parseAndPrintFile(lint, filename);
-                }
+            if ((lint->appOptions & XML_LINT_TIMINGS) && (lint->repeat > 1)) {
+                endTimer(lint, "%d iterations", lint->repeat);
             }
+            if (lint->benchmark > 0)
+                benchReport(lint, filename);
 
-            xmlFreeParserCtxt(ctxt);
-        }
-
-        if ((lint->appOptions & XML_LINT_TIMINGS) && (lint->repeat > 1)) {
-            endTimer(lint, "%d iterations", lint->repeat);
-        }
-
-        files += 1;
+            files += 1;
 
 #if HAVE_DECL_MMAP
-        if (lint->appOptions & XML_LINT_MEMORY) {
-            munmap(lint->memoryData, lint->memorySize);
-            close(memoryFd);
-        }
+            if (lint->appOptions & XML_LINT_MEMORY) {
+                munmap(lint->memoryData, lint->memorySize);
+                close(memoryFd);
+            }
 #endif
+        }
     }
 
     if (lint->appOptions & XML_LINT_GENERATE)
@@ -3307,6 +4110,18 @@ error:
     if (lint->patternc != NULL)
         xmlFreePattern(lint->patternc);
 #endif
+#if defined(LIBXML_READER_ENABLED) && defined(LIBXML_PATTERN_ENABLED) && \
+    defined(LIBXML_XPATH_ENABLED)
+    if (lint->xpathpatc != NULL)
+        xmlFreePattern(lint->xpathpatc);
+#endif
+
+    free(lint->benchTimes);
+
+    if (lint->appOptions & XML_LINT_ALLOC_PROFILE) {
+        xmlMemProfileStop();
+        xmlMemProfileDump(errStream);
+    }
 
     xmlCleanupParser();
 
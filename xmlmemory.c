@@ -18,12 +18,14 @@
 #include <libxml/threads.h>
 
 #include "private/error.h"
+#include "private/globals.h"
 #include "private/memory.h"
 #include "private/threads.h"
 
 static unsigned long  debugMemSize = 0;
 static unsigned long  debugMemBlocks = 0;
 static xmlMutex xmlMemMutex;
+static xmlMutex xmlPoolMutex;
 
 /************************************************************************
  *									*
@@ -39,6 +41,10 @@ static xmlMutex xmlMemMutex;
 
 typedef struct memnod {
     unsigned int   mh_tag;
+    /* whether the block was charged to a memory budget */
+    unsigned short mh_charged;
+    /* profiled call site of the block or 0 */
+    unsigned short mh_site;
     size_t         mh_size;
 } MEMHDR;
 
@@ -55,96 +61,649 @@ typedef struct memnod {
 #define CLIENT_2_HDR(a) ((void *) (((char *) (a)) - RESERVE_SIZE))
 #define HDR_2_CLIENT(a)    ((void *) (((char *) (a)) + RESERVE_SIZE))
 
+/************************************************************************
+ *									*
+ *			Memory budgets					*
+ *									*
+ ************************************************************************/
+
+/*
+ * The budget of the context which is currently parsing or validating
+ * in this thread. Budgets can only be enforced by allocators which
+ * record the size of blocks.
+ *
+ * Without thread-local storage, use a separate thread-specific key
+ * instead of the global state. Memory can be freed in thread
+ * destructors after the global state was released. The key is never
+ * deleted for the same reason. Thread-specific lookups are skipped
+ * until the first budget was created, so allocations don't pay for
+ * them unless budgets are used.
+ */
+#ifndef LIBXML_THREAD_ENABLED
+static xmlMemBudget *memBudgetCurrent;
+#define MEM_BUDGET_GET() memBudgetCurrent
+#define MEM_BUDGET_SET(b) memBudgetCurrent = (b)
+#elif defined(XML_THREAD_LOCAL)
+static XML_THREAD_LOCAL xmlMemBudget *memBudgetCurrent;
+#define MEM_BUDGET_GET() memBudgetCurrent
+#define MEM_BUDGET_SET(b) memBudgetCurrent = (b)
+#elif defined(HAVE_POSIX_THREADS)
+static pthread_key_t memBudgetKey;
+static int memBudgetKeyCreated;
+static int memBudgetUsed;
+#define MEM_BUDGET_KEY
+#define MEM_BUDGET_GET() \
+    (memBudgetUsed ? \
+     (xmlMemBudget *) pthread_getspecific(memBudgetKey) : NULL)
+#define MEM_BUDGET_SET(b) pthread_setspecific(memBudgetKey, (b))
+#elif defined(HAVE_WIN32_THREADS)
+static DWORD memBudgetKey;
+static int memBudgetKeyCreated;
+static int memBudgetUsed;
+#define MEM_BUDGET_KEY
+#define MEM_BUDGET_GET() \
+    (memBudgetUsed ? \
+     (xmlMemBudget *) TlsGetValue(memBudgetKey) : NULL)
+#define MEM_BUDGET_SET(b) TlsSetValue(memBudgetKey, (b))
+#endif
+
+#ifdef MEM_BUDGET_GET
+#define MEM_BUDGET_ENABLED
+#endif
+
 /**
- * @deprecated don't use
+ * Charge a new block to the current memory budget.
  *
- * @param size  an int specifying the size in byte to allocate.
- * @param file  the file name or NULL
- * @param line  the line number
- * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ * @param size  size of the block
+ * @returns 1 if the block was charged, 0 if there's no budget or -1
+ * if the budget would be exceeded.
  */
-void *
-xmlMallocLoc(size_t size, const char *file ATTRIBUTE_UNUSED,
-             int line ATTRIBUTE_UNUSED)
-{
-    return(xmlMemMalloc(size));
+static int
+xmlMemBudgetCharge(size_t size) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *budget = MEM_BUDGET_GET();
+
+    if (budget != NULL) {
+        if ((budget->used > budget->max) ||
+            (size > budget->max - budget->used)) {
+            budget->exceeded = 1;
+            return(-1);
+        }
+        budget->used += size;
+        return(1);
+    }
+#else
+    (void) size;
+#endif
+
+    return(0);
 }
 
 /**
- * @deprecated don't use
+ * Return the memory of a block to the current memory budget.
  *
- * @param size  an unsigned int specifying the size in byte to allocate.
+ * Blocks which outlive a parse or validation run aren't credited
+ * to the budget when they're freed later.
+ *
+ * @param p  the block header
+ */
+static void
+xmlMemBudgetCredit(MEMHDR *p) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *budget = MEM_BUDGET_GET();
+
+    if ((budget != NULL) && (p->mh_charged)) {
+        if (budget->used > p->mh_size)
+            budget->used -= p->mh_size;
+        else
+            budget->used = 0;
+    }
+#else
+    (void) p;
+#endif
+}
+
+/**
+ * Undo #xmlMemBudgetCharge after a failed allocation.
+ *
+ * @param charged  result of #xmlMemBudgetCharge
+ * @param size  size of the block
+ */
+static void
+xmlMemBudgetUncharge(int charged, size_t size) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *budget = MEM_BUDGET_GET();
+
+    if ((charged > 0) && (budget != NULL))
+        budget->used -= size;
+#else
+    (void) charged;
+    (void) size;
+#endif
+}
+
+/**
+ * Charge a block which is resized to the current memory budget.
+ *
+ * @param p  the block header
+ * @param size  the new size
+ * @returns the new value of mh_charged or -1 if the budget would be
+ * exceeded.
+ */
+static int
+xmlMemBudgetResize(MEMHDR *p, size_t size) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *budget = MEM_BUDGET_GET();
+    size_t used;
+
+    if (budget == NULL)
+        return(p->mh_charged);
+
+    used = budget->used;
+    if (p->mh_charged)
+        used = (used > p->mh_size) ? used - p->mh_size : 0;
+    if ((used > budget->max) || (size > budget->max - used)) {
+        budget->exceeded = 1;
+        return(-1);
+    }
+    budget->used = used + size;
+    return(1);
+#else
+    (void) size;
+
+    return(p->mh_charged);
+#endif
+}
+
+/**
+ * Undo #xmlMemBudgetResize after a failed reallocation.
+ *
+ * @param p  the unchanged block header
+ * @param charged  result of #xmlMemBudgetResize
+ * @param size  the requested size
+ */
+static void
+xmlMemBudgetRevert(MEMHDR *p, int charged, size_t size) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *budget = MEM_BUDGET_GET();
+
+    if ((budget != NULL) && (charged > 0)) {
+        budget->used -= size;
+        if (p->mh_charged)
+            budget->used += p->mh_size;
+    }
+#else
+    (void) p;
+    (void) charged;
+    (void) size;
+#endif
+}
+
+/**
+ * Create, update or remove a memory budget. Budgets require an
+ * allocator which records block sizes, see #xmlPoolMalloc and
+ * #xmlMemMalloc.
+ *
+ * @param budget  pointer to the budget of a context
+ * @param max  maximum number of bytes or 0 to remove the budget
+ * @returns 0 on success or -1 if budgets aren't supported or
+ * a memory allocation failed.
+ */
+int
+xmlMemBudgetSet(xmlMemBudget **budget, size_t max) {
+    if (max == 0) {
+        xmlFree(*budget);
+        *budget = NULL;
+        return(0);
+    }
+
+#ifdef MEM_BUDGET_ENABLED
+#ifdef MEM_BUDGET_KEY
+    if (!memBudgetKeyCreated)
+        return(-1);
+#endif
+    if ((xmlMalloc != xmlPoolMalloc) && (xmlMalloc != xmlMemMalloc))
+        return(-1);
+
+    if (*budget == NULL) {
+        *budget = xmlMalloc(sizeof(**budget));
+        if (*budget == NULL)
+            return(-1);
+        (*budget)->used = 0;
+        (*budget)->exceeded = 0;
+#ifdef MEM_BUDGET_KEY
+        if (!memBudgetUsed)
+            memBudgetUsed = 1;
+#endif
+    }
+    (*budget)->max = max;
+
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+/**
+ * Reset the accounting of a budget before a new run.
+ *
+ * @param budget  the budget (optional)
+ */
+void
+xmlMemBudgetReset(xmlMemBudget *budget) {
+    if (budget != NULL) {
+        budget->used = 0;
+        budget->exceeded = 0;
+    }
+}
+
+/**
+ * Charge allocations of the current thread to a budget. Does nothing
+ * if `budget` is NULL, so that the budget of an outer context stays
+ * active.
+ *
+ * @param budget  the budget (optional)
+ * @returns the previous budget which must be passed to
+ * #xmlMemBudgetLeave.
+ */
+xmlMemBudget *
+xmlMemBudgetEnter(xmlMemBudget *budget) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *prev = MEM_BUDGET_GET();
+
+    if ((budget != NULL) && (budget != prev))
+        MEM_BUDGET_SET(budget);
+
+    return(prev);
+#else
+    (void) budget;
+
+    return(NULL);
+#endif
+}
+
+/**
+ * Restore the budget which was active before #xmlMemBudgetEnter.
+ *
+ * @param prev  the previous budget
+ */
+void
+xmlMemBudgetLeave(xmlMemBudget *prev) {
+#ifdef MEM_BUDGET_ENABLED
+    if (MEM_BUDGET_GET() != prev)
+        MEM_BUDGET_SET(prev);
+#else
+    (void) prev;
+#endif
+}
+
+/**
+ * Stop charging allocations of the current thread until
+ * #xmlMemBudgetLeave is called.
+ *
+ * @returns the previous budget which must be passed to
+ * #xmlMemBudgetLeave.
+ */
+xmlMemBudget *
+xmlMemBudgetSuspend(void) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *prev = MEM_BUDGET_GET();
+
+    if (prev != NULL)
+        MEM_BUDGET_SET(NULL);
+
+    return(prev);
+#else
+    return(NULL);
+#endif
+}
+
+/**
+ * @returns 1 if the current budget was exceeded, 0 otherwise.
+ */
+int
+xmlMemBudgetExceeded(void) {
+#ifdef MEM_BUDGET_ENABLED
+    xmlMemBudget *budget = MEM_BUDGET_GET();
+
+    return((budget != NULL) && (budget->exceeded));
+#else
+    return(0);
+#endif
+}
+
+/************************************************************************
+ *									*
+ *			Allocation profiler				*
+ *									*
+ ************************************************************************/
+
+/*
+ * Call sites are identified by the file and line passed to the *Loc
+ * functions or, for the library's own allocations through xmlMalloc,
+ * by the return address of the allocator.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define MEM_CALLER() __builtin_return_address(0)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define MEM_CALLER() _ReturnAddress()
+#else
+#define MEM_CALLER() NULL
+#endif
+
+/*
+ * The site table is split into shards with separate locks, so that
+ * threads allocating from different call sites rarely contend. Block
+ * headers store the index of their site plus one, which must fit into
+ * an unsigned short.
+ */
+#define PROFILE_SHARDS 16
+#define PROFILE_SHARD_SITES 1024
+
+typedef struct {
+    int used;
+    const void *addr;
+    const char *file;
+    int line;
+    size_t count;
+    size_t bytes;
+    size_t live;
+    size_t peak;
+} xmlMemSite;
+
+typedef struct {
+    xmlMutex mutex;
+    size_t dropped;
+    xmlMemSite sites[PROFILE_SHARD_SITES];
+} xmlMemProfileShard;
+
+/* Allocated on first use and never freed, protected by xmlMemMutex */
+static xmlMemProfileShard *memProfile;
+static int memProfileEnabled;
+
+/**
+ * Record an allocation at a call site.
+ *
+ * @param addr  return address of the allocator
  * @param file  the file name or NULL
  * @param line  the line number
- * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ * @param size  size of the block
+ * @returns the site index to store in the block header or 0 if the
+ * site table is full.
  */
-void *
-xmlMallocAtomicLoc(size_t size, const char *file ATTRIBUTE_UNUSED,
-                   int line ATTRIBUTE_UNUSED)
-{
-    return(xmlMemMalloc(size));
+static unsigned
+xmlMemProfileAlloc(const void *addr, const char *file, int line,
+                   size_t size) {
+    xmlMemProfileShard *shard;
+    xmlMemSite *site = NULL;
+    size_t hash;
+    unsigned slot, i;
+
+    if (file != NULL)
+        addr = NULL;
+
+    hash = (size_t) addr ^ ((size_t) file * 31) ^ (unsigned) line;
+    hash ^= hash >> 17;
+    hash *= 0x9E3779B1U;
+    hash ^= hash >> 15;
+
+    shard = &memProfile[hash % PROFILE_SHARDS];
+    slot = (hash / PROFILE_SHARDS) % PROFILE_SHARD_SITES;
+
+    xmlMutexLock(&shard->mutex);
+
+    for (i = 0; i < PROFILE_SHARD_SITES; i++) {
+        site = &shard->sites[slot];
+
+        if (!site->used) {
+            site->used = 1;
+            site->addr = addr;
+            site->file = file;
+            site->line = line;
+            break;
+        }
+        if ((site->addr == addr) && (site->file == file) &&
+            (site->line == line))
+            break;
+
+        slot = (slot + 1) % PROFILE_SHARD_SITES;
+    }
+
+    if (i >= PROFILE_SHARD_SITES) {
+        shard->dropped++;
+        xmlMutexUnlock(&shard->mutex);
+        return(0);
+    }
+
+    site->count++;
+    site->bytes += size;
+    site->live += size;
+    if (site->live > site->peak)
+        site->peak = site->live;
+
+    xmlMutexUnlock(&shard->mutex);
+
+    return((shard - memProfile) * PROFILE_SHARD_SITES + slot + 1);
 }
 
 /**
- * a malloc() equivalent, with logging of the allocation info.
+ * Credit a freed block to its call site.
  *
- * @param size  an int specifying the size in byte to allocate.
- * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ * @param p  the block header
  */
-void *
-xmlMemMalloc(size_t size)
-{
-    MEMHDR *p;
+static void
+xmlMemProfileFree(MEMHDR *p) {
+    xmlMemProfileShard *shard;
+    xmlMemSite *site;
+    unsigned idx = p->mh_site - 1;
+
+    shard = &memProfile[idx / PROFILE_SHARD_SITES];
+    site = &shard->sites[idx % PROFILE_SHARD_SITES];
+
+    xmlMutexLock(&shard->mutex);
+    site->live -= p->mh_size;
+    xmlMutexUnlock(&shard->mutex);
+}
+
+/**
+ * Start recording the call sites of allocations made with
+ * #xmlMemMalloc, #xmlMemRealloc, #xmlMemoryStrdup and the
+ * corresponding *Loc functions. Install these functions with
+ * #xmlMemSetup before profiling the library.
+ *
+ * For each call site, the number of allocations, the total number
+ * of bytes, the bytes still allocated and the peak of allocated
+ * bytes are recorded. Reallocations count as a new allocation at the
+ * call site of the reallocation. If recording was stopped before,
+ * statistics are accumulated.
+ *
+ * @since 2.16.0
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+int
+xmlMemProfileStart(void) {
+    int ret = 0;
+    int i;
 
     xmlInitParser();
 
-    if (size > (MAX_SIZE_T - RESERVE_SIZE))
-        return(NULL);
+    xmlMutexLock(&xmlMemMutex);
 
-    p = (MEMHDR *) malloc(RESERVE_SIZE + size);
-    if (!p)
-        return(NULL);
-    p->mh_tag = MEMTAG;
-    p->mh_size = size;
+    if (memProfile == NULL) {
+        memProfile = calloc(PROFILE_SHARDS, sizeof(memProfile[0]));
+        if (memProfile == NULL) {
+            ret = -1;
+            goto done;
+        }
+        for (i = 0; i < PROFILE_SHARDS; i++)
+            xmlInitMutex(&memProfile[i].mutex);
+    }
+    memProfileEnabled = 1;
 
+done:
+    xmlMutexUnlock(&xmlMemMutex);
+    return(ret);
+}
+
+/**
+ * Stop recording the call sites of allocations. Blocks allocated
+ * while recording are still credited to their call site when
+ * they're freed.
+ *
+ * @since 2.16.0
+ */
+void
+xmlMemProfileStop(void) {
     xmlMutexLock(&xmlMemMutex);
-    debugMemSize += size;
-    debugMemBlocks++;
+    memProfileEnabled = 0;
     xmlMutexUnlock(&xmlMemMutex);
+}
 
-    return(HDR_2_CLIENT(p));
+static int
+xmlMemSiteCompare(const void *a, const void *b) {
+    const xmlMemSite *sa = a;
+    const xmlMemSite *sb = b;
+
+    if (sa->bytes != sb->bytes)
+        return((sa->bytes < sb->bytes) ? 1 : -1);
+    if (sa->count != sb->count)
+        return((sa->count < sb->count) ? 1 : -1);
+    return(0);
 }
 
 /**
- * @deprecated don't use
+ * Print the call sites recorded since #xmlMemProfileStart, sorted
+ * by the total number of bytes allocated.
  *
- * @param ptr  the initial memory block pointer
- * @param size  an int specifying the size in byte to allocate.
- * @param file  the file name or NULL
- * @param line  the line number
- * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ * Sites with a file name were passed to the *Loc functions. Other
+ * sites are shown as the return address of the allocator, which can
+ * be resolved with a debugger or addr2line.
+ *
+ * @since 2.16.0
+ * @param fp  the output stream
  */
-void *
-xmlReallocLoc(void *ptr, size_t size, const char *file ATTRIBUTE_UNUSED,
-              int line ATTRIBUTE_UNUSED)
-{
-    return(xmlMemRealloc(ptr, size));
+void
+xmlMemProfileDump(FILE *fp) {
+    xmlMemProfileShard *profile;
+    xmlMemSite *sites;
+    size_t num = 0, dropped = 0;
+    int i, j;
+
+    if (fp == NULL)
+        return;
+
+    xmlMutexLock(&xmlMemMutex);
+    profile = memProfile;
+    xmlMutexUnlock(&xmlMemMutex);
+
+    if (profile == NULL)
+        return;
+
+    sites = malloc(PROFILE_SHARDS * PROFILE_SHARD_SITES * sizeof(sites[0]));
+    if (sites == NULL)
+        return;
+
+    for (i = 0; i < PROFILE_SHARDS; i++) {
+        xmlMemProfileShard *shard = &profile[i];
+
+        xmlMutexLock(&shard->mutex);
+        for (j = 0; j < PROFILE_SHARD_SITES; j++) {
+            if (shard->sites[j].used)
+                sites[num++] = shard->sites[j];
+        }
+        dropped += shard->dropped;
+        xmlMutexUnlock(&shard->mutex);
+    }
+
+    qsort(sites, num, sizeof(sites[0]), xmlMemSiteCompare);
+
+    fprintf(fp, "%12s %14s %14s %14s  %s\n",
+            "allocs", "bytes", "live", "peak", "site");
+    for (i = 0; (size_t) i < num; i++) {
+        xmlMemSite *site = &sites[i];
+
+        fprintf(fp, "%12lu %14lu %14lu %14lu  ",
+                (unsigned long) site->count, (unsigned long) site->bytes,
+                (unsigned long) site->live, (unsigned long) site->peak);
+        if (site->file != NULL)
+            fprintf(fp, "%s:%d\n", site->file, site->line);
+        else
+            fprintf(fp, "%p\n", site->addr);
+    }
+    if (dropped > 0)
+        fprintf(fp, "%lu allocations not recorded, site table full\n",
+                (unsigned long) dropped);
+
+    free(sites);
 }
 
+/************************************************************************
+ *									*
+ *			Debug allocator					*
+ *									*
+ ************************************************************************/
+
 /**
- * a realloc() equivalent, with logging of the allocation info.
+ * Record a new block if profiling is enabled.
  *
- * @param ptr  the initial memory block pointer
- * @param size  an int specifying the size in byte to allocate.
- * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ * @param p  the block header
+ * @param addr  return address of the allocator
+ * @param file  the file name or NULL
+ * @param line  the line number
  */
-void *
-xmlMemRealloc(void *ptr, size_t size) {
+static void
+xmlMemAddBlock(MEMHDR *p, const void *addr, const char *file, int line) {
+    int profile;
+
+    xmlMutexLock(&xmlMemMutex);
+    debugMemSize += p->mh_size;
+    debugMemBlocks++;
+    profile = memProfileEnabled;
+    xmlMutexUnlock(&xmlMemMutex);
+
+    p->mh_site = profile ?
+                 xmlMemProfileAlloc(addr, file, line, p->mh_size) : 0;
+}
+
+static void *
+xmlMemMallocSite(size_t size, const void *addr, const char *file, int line)
+{
+    MEMHDR *p;
+    int charged;
+
+    xmlInitParser();
+
+    if (size > (MAX_SIZE_T - RESERVE_SIZE))
+        return(NULL);
+
+    charged = xmlMemBudgetCharge(size);
+    if (charged < 0)
+        return(NULL);
+
+    p = (MEMHDR *) malloc(RESERVE_SIZE + size);
+    if (!p) {
+        xmlMemBudgetUncharge(charged, size);
+        return(NULL);
+    }
+    p->mh_tag = MEMTAG;
+    p->mh_charged = charged;
+    p->mh_size = size;
+
+    xmlMemAddBlock(p, addr, file, line);
+
+    return(HDR_2_CLIENT(p));
+}
+
+static void *
+xmlMemReallocSite(void *ptr, size_t size, const void *addr,
+                  const char *file, int line) {
     MEMHDR *p, *tmp;
     size_t oldSize;
+    int charged, profile;
 
     if (ptr == NULL)
-        return(xmlMemMalloc(size));
+        return(xmlMemMallocSite(size, addr, file, line));
 
     xmlInitParser();
 
@@ -157,25 +716,119 @@ xmlMemRealloc(void *ptr, size_t size) {
         return(NULL);
     }
     oldSize = p->mh_size;
+
+    charged = xmlMemBudgetResize(p, size);
+    if (charged < 0)
+        return(NULL);
+
     p->mh_tag = ~MEMTAG;
 
     tmp = (MEMHDR *) realloc(p, RESERVE_SIZE + size);
     if (!tmp) {
         p->mh_tag = MEMTAG;
+        xmlMemBudgetRevert(p, charged, size);
         return(NULL);
     }
     p = tmp;
     p->mh_tag = MEMTAG;
-    p->mh_size = size;
+    p->mh_charged = charged;
 
     xmlMutexLock(&xmlMemMutex);
     debugMemSize -= oldSize;
     debugMemSize += size;
+    profile = memProfileEnabled;
     xmlMutexUnlock(&xmlMemMutex);
 
+    if (p->mh_site != 0)
+        xmlMemProfileFree(p);
+    p->mh_size = size;
+    p->mh_site = profile ? xmlMemProfileAlloc(addr, file, line, size) : 0;
+
     return(HDR_2_CLIENT(p));
 }
 
+static char *
+xmlMemStrdupSite(const char *str, const void *addr, const char *file,
+                 int line) {
+    char *s;
+    size_t size = strlen(str) + 1;
+
+    s = xmlMemMallocSite(size, addr, file, line);
+    if (s == NULL)
+        return(NULL);
+
+    memcpy(s, str, size);
+
+    return(s);
+}
+
+/**
+ * @deprecated don't use
+ *
+ * @param size  an int specifying the size in byte to allocate.
+ * @param file  the file name or NULL
+ * @param line  the line number
+ * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ */
+void *
+xmlMallocLoc(size_t size, const char *file, int line)
+{
+    return(xmlMemMallocSite(size, MEM_CALLER(), file, line));
+}
+
+/**
+ * @deprecated don't use
+ *
+ * @param size  an unsigned int specifying the size in byte to allocate.
+ * @param file  the file name or NULL
+ * @param line  the line number
+ * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ */
+void *
+xmlMallocAtomicLoc(size_t size, const char *file, int line)
+{
+    return(xmlMemMallocSite(size, MEM_CALLER(), file, line));
+}
+
+/**
+ * a malloc() equivalent, with logging of the allocation info.
+ *
+ * @param size  an int specifying the size in byte to allocate.
+ * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ */
+void *
+xmlMemMalloc(size_t size)
+{
+    return(xmlMemMallocSite(size, MEM_CALLER(), NULL, 0));
+}
+
+/**
+ * @deprecated don't use
+ *
+ * @param ptr  the initial memory block pointer
+ * @param size  an int specifying the size in byte to allocate.
+ * @param file  the file name or NULL
+ * @param line  the line number
+ * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ */
+void *
+xmlReallocLoc(void *ptr, size_t size, const char *file, int line)
+{
+    return(xmlMemReallocSite(ptr, size, MEM_CALLER(), file, line));
+}
+
+/**
+ * a realloc() equivalent, with logging of the allocation info.
+ *
+ * @param ptr  the initial memory block pointer
+ * @param size  an int specifying the size in byte to allocate.
+ * @returns a pointer to the allocated area or NULL in case of lack of memory.
+ */
+void *
+xmlMemRealloc(void *ptr, size_t size) {
+    return(xmlMemReallocSite(ptr, size, MEM_CALLER(), NULL, 0));
+}
+
 /**
  * a free() equivalent, with error checking.
  *
@@ -200,6 +853,9 @@ xmlMemFree(void *ptr)
         return;
     }
     p->mh_tag = ~MEMTAG;
+    xmlMemBudgetCredit(p);
+    if (p->mh_site != 0)
+        xmlMemProfileFree(p);
     memset(ptr, -1, p->mh_size);
 
     xmlMutexLock(&xmlMemMutex);
@@ -219,10 +875,9 @@ xmlMemFree(void *ptr)
  * @returns a pointer to the new string or NULL if allocation error occurred.
  */
 char *
-xmlMemStrdupLoc(const char *str, const char *file ATTRIBUTE_UNUSED,
-                int line ATTRIBUTE_UNUSED)
+xmlMemStrdupLoc(const char *str, const char *file, int line)
 {
-    return(xmlMemoryStrdup(str));
+    return(xmlMemStrdupSite(str, MEM_CALLER(), file, line));
 }
 
 /**
@@ -233,31 +888,7 @@ xmlMemStrdupLoc(const char *str, const char *file ATTRIBUTE_UNUSED,
  */
 char *
 xmlMemoryStrdup(const char *str) {
-    char *s;
-    size_t size = strlen(str) + 1;
-    MEMHDR *p;
-
-    xmlInitParser();
-
-    if (size > (MAX_SIZE_T - RESERVE_SIZE))
-        return(NULL);
-
-    p = (MEMHDR *) malloc(RESERVE_SIZE + size);
-    if (!p)
-        return(NULL);
-    p->mh_tag = MEMTAG;
-    p->mh_size = size;
-
-    xmlMutexLock(&xmlMemMutex);
-    debugMemSize += size;
-    debugMemBlocks++;
-    xmlMutexUnlock(&xmlMemMutex);
-
-    s = (char *) HDR_2_CLIENT(p);
-
-    memcpy(s, str, size);
-
-    return(s);
+    return(xmlMemStrdupSite(str, MEM_CALLER(), NULL, 0));
 }
 
 /**
@@ -367,6 +998,17 @@ xmlInitMemory(void) {
 void
 xmlInitMemoryInternal(void) {
     xmlInitMutex(&xmlMemMutex);
+    xmlInitMutex(&xmlPoolMutex);
+
+#if defined(MEM_BUDGET_KEY) && defined(HAVE_POSIX_THREADS)
+    if (!memBudgetKeyCreated)
+        memBudgetKeyCreated = (pthread_key_create(&memBudgetKey, NULL) == 0);
+#elif defined(MEM_BUDGET_KEY)
+    if (!memBudgetKeyCreated) {
+        memBudgetKey = TlsAlloc();
+        memBudgetKeyCreated = (memBudgetKey != TLS_OUT_OF_INDEXES);
+    }
+#endif
 }
 
 /**
@@ -394,6 +1036,7 @@ xmlCleanupMemoryInternal(void) {
      */
 #if !defined(LIBXML_THREAD_ENABLED) || !defined(_WIN32)
     xmlCleanupMutex(&xmlMemMutex);
+    xmlCleanupMutex(&xmlPoolMutex);
 #endif
 }
 
@@ -514,3 +1157,638 @@ xmlGcMemGet(xmlFreeFunc *freeFunc, xmlMallocFunc *mallocFunc,
     return(0);
 }
 
+
+/************************************************************************
+ *									*
+ *			Arena allocator					*
+ *									*
+ ************************************************************************/
+
+#define XML_ARENA_MIN_CHUNK (16 * 1024)
+#define XML_ARENA_MAX_CHUNK (1024 * 1024)
+#define XML_ARENA_ALIGN (2 * sizeof(void *))
+
+typedef struct {
+    char *mem;
+    size_t size;
+} xmlArenaChunk;
+
+/*
+ * Chunks are kept sorted by address so that ownership can be checked
+ * with a binary search.
+ */
+struct _xmlArena {
+    xmlArenaChunk *chunks;
+    int nbChunks;
+    int maxChunks;
+    char *cur;
+    char *end;
+    size_t nextSize;
+};
+
+/**
+ * Create an arena allocator. Memory allocated from an arena can't
+ * be freed individually. It's released when the whole arena is
+ * freed.
+ *
+ * @returns the new arena or NULL if a memory allocation failed.
+ */
+xmlArena *
+xmlArenaCreate(void) {
+    xmlArena *arena;
+
+    arena = xmlMalloc(sizeof(*arena));
+    if (arena == NULL)
+        return(NULL);
+    memset(arena, 0, sizeof(*arena));
+    arena->nextSize = XML_ARENA_MIN_CHUNK;
+
+    return(arena);
+}
+
+/**
+ * Free an arena and all memory allocated from it.
+ *
+ * @param arena  the arena (optional)
+ */
+void
+xmlArenaFree(xmlArena *arena) {
+    int i;
+
+    if (arena == NULL)
+        return;
+
+    for (i = 0; i < arena->nbChunks; i++)
+        xmlFree(arena->chunks[i].mem);
+    xmlFree(arena->chunks);
+    xmlFree(arena);
+}
+
+static char *
+xmlArenaNewChunk(xmlArena *arena, size_t size) {
+    char *mem;
+    int lo, hi;
+
+    if (arena->nbChunks >= arena->maxChunks) {
+        xmlArenaChunk *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(arena->maxChunks, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(NULL);
+        tmp = xmlRealloc(arena->chunks, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(NULL);
+        arena->chunks = tmp;
+        arena->maxChunks = newSize;
+    }
+
+    mem = xmlMalloc(size);
+    if (mem == NULL)
+        return(NULL);
+
+    lo = 0;
+    hi = arena->nbChunks;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (XML_PTR_TO_INT(arena->chunks[mid].mem) < XML_PTR_TO_INT(mem))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    memmove(&arena->chunks[lo + 1], &arena->chunks[lo],
+            (arena->nbChunks - lo) * sizeof(arena->chunks[0]));
+    arena->chunks[lo].mem = mem;
+    arena->chunks[lo].size = size;
+    arena->nbChunks += 1;
+
+    return(mem);
+}
+
+/**
+ * Allocate memory from an arena. The result is suitably aligned for
+ * tree structs.
+ *
+ * @param arena  the arena
+ * @param size  number of bytes
+ * @returns a pointer to the memory or NULL if a memory allocation
+ * failed.
+ */
+void *
+xmlArenaAlloc(xmlArena *arena, size_t size) {
+    char *ret;
+
+    if (size > SIZE_MAX - XML_ARENA_ALIGN)
+        return(NULL);
+    size = (size + XML_ARENA_ALIGN - 1) & ~(XML_ARENA_ALIGN - 1);
+
+    if ((size_t) (arena->end - arena->cur) >= size) {
+        ret = arena->cur;
+        arena->cur += size;
+        return(ret);
+    }
+
+    /*
+     * Large allocations get a chunk of their own and don't replace
+     * the current chunk.
+     */
+    if (size > arena->nextSize / 4)
+        return(xmlArenaNewChunk(arena, size));
+
+    ret = xmlArenaNewChunk(arena, arena->nextSize);
+    if (ret == NULL)
+        return(NULL);
+    arena->cur = ret + size;
+    arena->end = ret + arena->nextSize;
+    if (arena->nextSize < XML_ARENA_MAX_CHUNK)
+        arena->nextSize *= 2;
+
+    return(ret);
+}
+
+/**
+ * Allocate a copy of a string from an arena.
+ *
+ * @param arena  the arena
+ * @param str  the string
+ * @param len  length of the string
+ * @returns the zero-terminated copy or NULL if a memory allocation
+ * failed.
+ */
+xmlChar *
+xmlArenaStrndup(xmlArena *arena, const xmlChar *str, int len) {
+    xmlChar *ret;
+
+    if ((str == NULL) || (len < 0))
+        return(NULL);
+
+    ret = xmlArenaAlloc(arena, (size_t) len + 1);
+    if (ret == NULL)
+        return(NULL);
+    memcpy(ret, str, len);
+    ret[len] = 0;
+
+    return(ret);
+}
+
+/**
+ * Check whether memory was allocated from an arena.
+ *
+ * @param arena  the arena (optional)
+ * @param ptr  pointer to check
+ * @returns 1 if `ptr` belongs to the arena, 0 otherwise.
+ */
+int
+xmlArenaOwns(const xmlArena *arena, const void *ptr) {
+    XML_INTPTR_T p = XML_PTR_TO_INT(ptr);
+    int lo, hi;
+
+    if ((arena == NULL) || (arena->nbChunks == 0))
+        return(0);
+
+    /* Find the last chunk starting at or before ptr */
+    lo = 0;
+    hi = arena->nbChunks;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (XML_PTR_TO_INT(arena->chunks[mid].mem) <= p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return(0);
+
+    return(p - XML_PTR_TO_INT(arena->chunks[lo - 1].mem) <
+           (XML_INTPTR_T) arena->chunks[lo - 1].size);
+}
+
+/************************************************************************
+ *									*
+ *			Pool allocator					*
+ *									*
+ ************************************************************************/
+
+/*
+ * Pooled blocks use the same header as the debug allocator, with a
+ * different tag. Blocks larger than the largest size class are
+ * allocated with malloc.
+ */
+#define POOLTAG 0x5bb5U
+#define POOLTAG_LARGE 0x5cc5U
+
+#define POOL_CLASS_SIZE 16
+#define POOL_MAX_SIZE (XML_POOL_CLASSES * POOL_CLASS_SIZE)
+#define POOL_SLAB_SIZE (64 * 1024)
+/* Number of blocks moved between a thread and the global depot */
+#define POOL_BATCH 64
+/* Flush statistics to the global counters above this value */
+#define POOL_MAX_DELTA (64 * 1024)
+
+#define POOL_CLASS(size) (((size) + POOL_CLASS_SIZE - 1) / POOL_CLASS_SIZE - 1)
+#define POOL_BLOCK_SIZE(cls) (RESERVE_SIZE + ((cls) + 1) * POOL_CLASS_SIZE)
+
+typedef struct _xmlPoolSlab xmlPoolSlab;
+struct _xmlPoolSlab {
+    xmlPoolSlab *next;
+};
+
+#define POOL_SLAB_HEADER (((sizeof(xmlPoolSlab) + ALIGN_SIZE - 1) \
+                          / ALIGN_SIZE) * ALIGN_SIZE)
+
+/*
+ * Free blocks form singly linked lists through their first word.
+ * Batches are exchanged with the depot as a whole, so that cold
+ * lists never have to be walked. The first block of a batch stores
+ * the number of blocks in its header and links to the next batch
+ * through its second word.
+ */
+#define POOL_NEXT(block) (((void **) HDR_2_CLIENT(block))[0])
+#define POOL_NEXT_BATCH(block) (((void **) HDR_2_CLIENT(block))[1])
+
+/*
+ * Batches of free blocks returned by threads, protected by
+ * xmlPoolMutex. Slabs are never freed. They're only kept in a list,
+ * so that they don't show up as leaks.
+ */
+static void *poolDepot[XML_POOL_CLASSES];
+static xmlPoolSlab *poolSlabs;
+
+#if defined(LIBXML_THREAD_ENABLED) && defined(XML_THREAD_LOCAL)
+/*
+ * Looking up the global state is too slow for every allocation, so
+ * keep a direct pointer to the pool state of the current thread.
+ */
+static XML_THREAD_LOCAL xmlPoolCache *poolCurrent;
+#define POOL_USE_CURRENT
+#endif
+
+/**
+ * @returns the pool state of the current thread.
+ */
+static xmlPoolCache *
+xmlPoolGetCache(void) {
+#ifdef POOL_USE_CURRENT
+    xmlPoolCache *cache = poolCurrent;
+
+    if (cache == NULL) {
+        cache = xmlGetLocalPoolCache();
+        poolCurrent = cache;
+    }
+
+    return(cache);
+#else
+    return(xmlGetLocalPoolCache());
+#endif
+}
+
+/**
+ * Add the statistics of a thread to the global counters.
+ * Must be called with xmlMemMutex held.
+ *
+ * @param cache  the thread's pool state
+ */
+static void
+xmlPoolFlushStats(xmlPoolCache *cache) {
+    debugMemSize += cache->sizeDelta;
+    debugMemBlocks += cache->blocksDelta;
+    cache->sizeDelta = 0;
+    cache->blocksDelta = 0;
+}
+
+/**
+ * Add a batch of free blocks to the global depot.
+ *
+ * @param cls  size class
+ * @param batch  first block of the batch
+ * @param num  number of blocks
+ */
+static void
+xmlPoolPushBatch(int cls, MEMHDR *batch, unsigned num) {
+    batch->mh_size = num;
+
+    xmlMutexLock(&xmlPoolMutex);
+    POOL_NEXT_BATCH(batch) = poolDepot[cls];
+    poolDepot[cls] = batch;
+    xmlMutexUnlock(&xmlPoolMutex);
+}
+
+/**
+ * Refill the empty free list of a size class from the spare batch,
+ * the global depot or the current slab.
+ *
+ * @param cache  the thread's pool state
+ * @param cls  size class
+ * @returns 0 on success, -1 if a memory allocation failed.
+ */
+static int
+xmlPoolRefill(xmlPoolCache *cache, int cls) {
+    size_t blockSize = POOL_BLOCK_SIZE(cls);
+    MEMHDR *block;
+
+    if (cache->spare[cls] != NULL) {
+        cache->freeList[cls] = cache->spare[cls];
+        cache->count[cls] = POOL_BATCH;
+        cache->spare[cls] = NULL;
+        return(0);
+    }
+
+    xmlMutexLock(&xmlPoolMutex);
+    block = poolDepot[cls];
+    if (block != NULL)
+        poolDepot[cls] = POOL_NEXT_BATCH(block);
+    xmlMutexUnlock(&xmlPoolMutex);
+
+    if (block != NULL) {
+        cache->freeList[cls] = block;
+        cache->count[cls] = block->mh_size;
+        return(0);
+    }
+
+    if ((size_t) (cache->end - cache->cur) < blockSize) {
+        xmlPoolSlab *slab;
+
+        slab = malloc(POOL_SLAB_SIZE);
+        if (slab == NULL)
+            return(-1);
+
+        xmlMutexLock(&xmlPoolMutex);
+        slab->next = poolSlabs;
+        poolSlabs = slab;
+        xmlMutexUnlock(&xmlPoolMutex);
+
+        cache->cur = (char *) slab + POOL_SLAB_HEADER;
+        cache->end = (char *) slab + POOL_SLAB_SIZE;
+    }
+
+    block = (MEMHDR *) cache->cur;
+    cache->cur += blockSize;
+    POOL_NEXT(block) = NULL;
+    cache->freeList[cls] = block;
+    cache->count[cls] = 1;
+
+    return(0);
+}
+
+/**
+ * Return all free blocks cached by a thread to the global depot
+ * and flush its statistics. Called when a thread exits.
+ *
+ * @param cache  the thread's pool state
+ */
+void
+xmlPoolCacheRelease(xmlPoolCache *cache) {
+    int cls;
+
+    for (cls = 0; cls < XML_POOL_CLASSES; cls++) {
+        if (cache->count[cls] > 0)
+            xmlPoolPushBatch(cls, cache->freeList[cls], cache->count[cls]);
+        if (cache->spare[cls] != NULL)
+            xmlPoolPushBatch(cls, cache->spare[cls], POOL_BATCH);
+        cache->freeList[cls] = NULL;
+        cache->count[cls] = 0;
+        cache->spare[cls] = NULL;
+    }
+    cache->cur = NULL;
+    cache->end = NULL;
+
+#ifdef POOL_USE_CURRENT
+    if (poolCurrent == cache)
+        poolCurrent = NULL;
+#endif
+
+    if ((cache->sizeDelta != 0) || (cache->blocksDelta != 0)) {
+        xmlMutexLock(&xmlMemMutex);
+        xmlPoolFlushStats(cache);
+        xmlMutexUnlock(&xmlMemMutex);
+    }
+}
+
+/**
+ * Update the statistics of a thread.
+ *
+ * @param cache  the thread's pool state
+ * @param size  change of allocated bytes
+ * @param blocks  change of allocated blocks
+ */
+static void
+xmlPoolAccount(xmlPoolCache *cache, long size, long blocks) {
+    cache->sizeDelta += size;
+    cache->blocksDelta += blocks;
+
+    if ((cache->sizeDelta > POOL_MAX_DELTA) ||
+        (cache->sizeDelta < -POOL_MAX_DELTA)) {
+        xmlMutexLock(&xmlMemMutex);
+        xmlPoolFlushStats(cache);
+        xmlMutexUnlock(&xmlMemMutex);
+    }
+}
+
+/**
+ * A malloc() equivalent which serves small allocations from
+ * thread-local free lists. Blocks up to 256 bytes are grouped into
+ * size classes of 16 bytes. Threads maintain a cache of free blocks
+ * for each class and only exchange batches of blocks with a global
+ * depot, so most allocations don't take a lock. Memory of small
+ * blocks isn't returned to the system.
+ *
+ * Install with
+ *
+ *     xmlMemSetup(xmlPoolFree, xmlPoolMalloc, xmlPoolRealloc,
+ *                 xmlPoolStrdup);
+ *
+ * before any other library calls. #xmlMemUsed and #xmlMemBlocks
+ * report the memory allocated through the pool. Statistics are
+ * collected per thread and can lag behind by up to 64 KB per thread.
+ *
+ * @since 2.16.0
+ *
+ * @param size  number of bytes to allocate
+ * @returns a pointer to the allocated area or NULL in case of lack
+ * of memory.
+ */
+void *
+xmlPoolMalloc(size_t size) {
+    xmlPoolCache *cache;
+    MEMHDR *p;
+    int charged;
+
+    charged = xmlMemBudgetCharge(size);
+    if (charged < 0)
+        return(NULL);
+
+    cache = xmlPoolGetCache();
+
+    if (size <= POOL_MAX_SIZE) {
+        int cls = (size == 0) ? 0 : POOL_CLASS(size);
+
+        if ((cache->freeList[cls] == NULL) &&
+            (xmlPoolRefill(cache, cls) < 0)) {
+            xmlMemBudgetUncharge(charged, size);
+            return(NULL);
+        }
+
+        p = cache->freeList[cls];
+        cache->freeList[cls] = POOL_NEXT(p);
+        cache->count[cls]--;
+        p->mh_tag = POOLTAG;
+    } else {
+        p = NULL;
+        if (size <= (MAX_SIZE_T - RESERVE_SIZE))
+            p = (MEMHDR *) malloc(RESERVE_SIZE + size);
+        if (!p) {
+            xmlMemBudgetUncharge(charged, size);
+            return(NULL);
+        }
+        p->mh_tag = POOLTAG_LARGE;
+    }
+
+    p->mh_charged = charged;
+    p->mh_size = size;
+    xmlPoolAccount(cache, size, 1);
+
+    return(HDR_2_CLIENT(p));
+}
+
+/**
+ * A free() equivalent for memory allocated with #xmlPoolMalloc.
+ * Blocks can be freed from any thread.
+ *
+ * @since 2.16.0
+ *
+ * @param ptr  the memory block pointer
+ */
+void
+xmlPoolFree(void *ptr) {
+    xmlPoolCache *cache;
+    MEMHDR *p;
+
+    if (ptr == NULL)
+        return;
+
+    p = CLIENT_2_HDR(ptr);
+    if ((p->mh_tag != POOLTAG) && (p->mh_tag != POOLTAG_LARGE)) {
+        xmlPrintErrorMessage("xmlPoolFree: Tag error\n");
+        return;
+    }
+
+    xmlMemBudgetCredit(p);
+
+    cache = xmlPoolGetCache();
+    xmlPoolAccount(cache, -(long) p->mh_size, -1);
+
+    if (p->mh_tag == POOLTAG_LARGE) {
+        p->mh_tag = ~POOLTAG_LARGE;
+        free(p);
+    } else {
+        int cls = (p->mh_size == 0) ? 0 : POOL_CLASS(p->mh_size);
+
+        p->mh_tag = ~POOLTAG;
+
+        if (cache->count[cls] >= POOL_BATCH) {
+            /* Keep one full batch and hand the older one to the depot */
+            if (cache->spare[cls] != NULL)
+                xmlPoolPushBatch(cls, cache->spare[cls], POOL_BATCH);
+            cache->spare[cls] = cache->freeList[cls];
+            cache->freeList[cls] = NULL;
+            cache->count[cls] = 0;
+        }
+
+        POOL_NEXT(p) = cache->freeList[cls];
+        cache->freeList[cls] = p;
+        cache->count[cls]++;
+    }
+}
+
+/**
+ * A realloc() equivalent for memory allocated with #xmlPoolMalloc.
+ *
+ * @since 2.16.0
+ *
+ * @param ptr  the initial memory block pointer
+ * @param size  number of bytes to allocate
+ * @returns a pointer to the allocated area or NULL in case of lack
+ * of memory.
+ */
+void *
+xmlPoolRealloc(void *ptr, size_t size) {
+    MEMHDR *p, *tmp;
+    void *ret;
+    size_t oldSize;
+    int charged;
+
+    if (ptr == NULL)
+        return(xmlPoolMalloc(size));
+
+    p = CLIENT_2_HDR(ptr);
+    if ((p->mh_tag != POOLTAG) && (p->mh_tag != POOLTAG_LARGE)) {
+        xmlPrintErrorMessage("xmlPoolRealloc: Tag error\n");
+        return(NULL);
+    }
+    oldSize = p->mh_size;
+
+    if ((p->mh_tag == POOLTAG) && (size > 0) && (oldSize > 0) &&
+        (POOL_CLASS(size) == POOL_CLASS(oldSize))) {
+        /* Same size class */
+        charged = xmlMemBudgetResize(p, size);
+        if (charged < 0)
+            return(NULL);
+        p->mh_charged = charged;
+        p->mh_size = size;
+        xmlPoolAccount(xmlPoolGetCache(), (long) size - (long) oldSize,
+                       0);
+        return(ptr);
+    }
+
+    if ((p->mh_tag == POOLTAG_LARGE) && (size > POOL_MAX_SIZE)) {
+        if (size > (MAX_SIZE_T - RESERVE_SIZE))
+            return(NULL);
+
+        charged = xmlMemBudgetResize(p, size);
+        if (charged < 0)
+            return(NULL);
+
+        tmp = (MEMHDR *) realloc(p, RESERVE_SIZE + size);
+        if (!tmp) {
+            xmlMemBudgetRevert(p, charged, size);
+            return(NULL);
+        }
+        tmp->mh_charged = charged;
+        tmp->mh_size = size;
+        xmlPoolAccount(xmlPoolGetCache(), (long) size - (long) oldSize,
+                       0);
+        return(HDR_2_CLIENT(tmp));
+    }
+
+    ret = xmlPoolMalloc(size);
+    if (ret == NULL)
+        return(NULL);
+    memcpy(ret, ptr, size < oldSize ? size : oldSize);
+    xmlPoolFree(ptr);
+
+    return(ret);
+}
+
+/**
+ * A strdup() equivalent for #xmlPoolMalloc.
+ *
+ * @since 2.16.0
+ *
+ * @param str  the initial string pointer
+ * @returns a pointer to the new string or NULL if allocation error
+ * occurred.
+ */
+char *
+xmlPoolStrdup(const char *str) {
+    size_t size = strlen(str) + 1;
+    char *ret;
+
+    ret = xmlPoolMalloc(size);
+    if (ret != NULL)
+        memcpy(ret, str, size);
+
+    return(ret);
+}
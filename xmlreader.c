@@ -46,11 +46,17 @@
 #include "private/io.h"
 #include "private/memory.h"
 #include "private/parser.h"
+#include "private/schemas.h"
 #include "private/tree.h"
 #ifdef LIBXML_XINCLUDE_ENABLED
 #include "private/xinclude.h"
 #endif
 
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #include <pthread.h>
+  #define XML_TEXTREADER_PIPELINE
+#endif
+
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 /* Keeping free objects can hide memory errors. */
 #define MAX_FREE_NODES 1
@@ -95,6 +101,87 @@ typedef enum {
     XML_TEXTREADER_VALIDATE_XSD = 4
 } xmlTextReaderValidate;
 
+/*
+ * Flat mode: the SAX callbacks queue events instead of building a tree.
+ */
+#define XML_TEXTREADER_FLAT_END     1
+#define XML_TEXTREADER_FLAT_EMPTY   2
+
+typedef struct {
+    xmlElementType   type;      /* element, text, comment, PI ... */
+    int              flags;     /* XML_TEXTREADER_FLAT_* */
+    int              depth;
+    const xmlChar   *name;      /* local name, PI target or entity name */
+    const xmlChar   *prefix;
+    const xmlChar   *URI;
+    int              content;   /* offset of the content in text */
+    int              contentLen;
+    int              attrs;     /* first namespace or attribute */
+    int              nbNs;
+    int              nbAttrs;
+} xmlTextReaderFlatEvent;
+
+typedef struct {
+    const xmlChar   *name;      /* local name, or prefix of a declaration */
+    const xmlChar   *prefix;
+    const xmlChar   *URI;       /* namespace name */
+    int              value;     /* offset of the value in text */
+    int              valueLen;
+} xmlTextReaderFlatAttr;
+
+/*
+ * Element exposed at a given depth, refilled for each start tag.
+ */
+typedef struct {
+    xmlNode          node;
+    xmlNs           *nsTab;
+    int              nsMax;
+    xmlAttr         *attrTab;
+    xmlNode         *textTab;
+    int              attrMax;
+    xmlChar         *values;
+    int              valuesMax;
+} xmlTextReaderFlatElem;
+
+/*
+ * Queued events with their namespaces, attributes and content.
+ */
+typedef struct {
+    xmlTextReaderFlatEvent *tab;
+    int                     nr;
+    int                     max;
+    xmlTextReaderFlatAttr  *attrTab;
+    int                     attrNr;
+    int                     attrMax;
+    xmlChar                *text;
+    int                     textNr;
+    int                     textMax;
+} xmlTextReaderFlatQueue;
+
+/*
+ * Pipelined mode: a parser thread fills queues handed to the reader.
+ */
+typedef struct _xmlTextReaderPipe xmlTextReaderPipe;
+
+#ifdef XML_TEXTREADER_PIPELINE
+/* Minimum number of events handed to the reader at once */
+#define XML_TEXTREADER_PIPE_BATCH 512
+/* Input parsed at once by the parser thread */
+#define XML_TEXTREADER_PIPE_CHUNK 4096
+
+struct _xmlTextReaderPipe {
+    pthread_t               thread;
+    pthread_mutex_t         lock;
+    pthread_cond_t          cond;
+    xmlTextReaderFlatQueue *ready;   /* filled queue for the reader */
+    xmlTextReaderFlatQueue *free;    /* drained queue for the parser */
+    xmlDocPtr               doc;     /* document of exposed nodes */
+    int                     stop;    /* the reader asks to stop */
+    int                     done;    /* the parser thread finished */
+    int                     result;  /* -1 if parsing failed */
+};
+#endif
+
 struct _xmlTextReader {
     int				mode;	/* the parsing mode */
     xmlDocPtr			doc;    /* when walking an existing doc */
@@ -144,7 +231,7 @@ struct _xmlTextReader {
     xmlSchemaValidCtxtPtr xsdValidCtxt;/* The Schemas validation context */
     int                   xsdPreserveCtxt; /* 1 if the context was provided by the user */
     int                   xsdValidErrors;/* The number of errors detected */
-    xmlSchemaSAXPlugPtr   xsdPlug;	/* the schemas plug in SAX pipeline */
+    int                   xsdAttached;	/* validation context attached to the parser */
 #endif
 #ifdef LIBXML_XINCLUDE_ENABLED
     /* Handling of XInclude processing */
@@ -156,6 +243,10 @@ struct _xmlTextReader {
     int                patternNr;       /* number of preserve patterns */
     int                patternMax;      /* max preserve patterns */
     xmlPatternPtr     *patternTab;      /* array of preserve patterns */
+    xmlPatternSetPtr   patternSet;      /* the same patterns merged */
+    xmlPatternSetStreamPtr patternStream; /* matches elements when parsed */
+    int                patternDepth;    /* open elements in matches */
+    int                patternPrune;    /* drop subtrees without matches */
 #endif
     int                preserves;	/* level of preserves */
     int                parserFlags;	/* the set of options set */
@@ -164,14 +255,52 @@ struct _xmlTextReader {
 
     xmlResourceLoader resourceLoader;
     void *resourceCtxt;
+
+    /* Flat event mode */
+    int                     flat;        /* is flat mode enabled */
+    xmlTextReaderFlatQueue  flatQueues[3];
+    xmlTextReaderFlatQueue *flatQ;       /* events read by the reader */
+    xmlTextReaderFlatQueue *flatFill;    /* events added by the parser */
+    int                     flatCur;     /* index of the current event */
+    int                     flatDepth;   /* open elements while parsing */
+    int                     flatEmpty;   /* last start tag was empty */
+    xmlTextReaderFlatElem **flatElemTab; /* exposed element per depth */
+    int                     flatElemMax;
+    xmlNode                 flatLeaf;    /* exposed text, comment, PI ... */
+    xmlNodePtr              flatTree;    /* subtree built by Expand */
+
+    /* Subtree skipping */
+    int                     skipping;    /* are SAX events dropped */
+    int                     skipOpen;    /* elements left to close */
+    int                     skipLevel;   /* nesting of dropped elements */
+    int                     skipEntities; /* saved replaceEntities */
+    xmlNodePtr              skipNode;    /* innermost open node */
+    xmlSAXHandler           skipSax;     /* saved SAX callbacks */
+
+    int                     pipelined;   /* parse in another thread */
+    xmlTextReaderPipe      *pipe;        /* running parser thread */
+
+    /* Attributes returned by xmlTextReaderGetAttributes */
+    xmlTextReaderAttr      *attrViewTab;
+    int                     attrViewMax;
+    xmlBufPtr               attrViewBuf; /* values with entity content */
 };
 
 #define NODE_IS_EMPTY		0x1
 #define NODE_IS_PRESERVED	0x2
 #define NODE_IS_SPRESERVED	0x4
+#define NODE_IS_MATCHED		0x8
+#define NODE_NO_MATCH_BELOW	0x10
 
 static int xmlTextReaderReadTree(xmlTextReaderPtr reader);
 static int xmlTextReaderNextTree(xmlTextReaderPtr reader);
+#ifdef LIBXML_PATTERN_ENABLED
+static void xmlTextReaderPatternFallback(xmlTextReaderPtr reader);
+static void xmlTextReaderPatternPush(xmlTextReaderPtr reader,
+                                     const xmlChar *localname,
+                                     const xmlChar *URI);
+static void xmlTextReaderPatternPop(xmlTextReaderPtr reader);
+#endif
 
 /**
  * Free a string if it is not owned by the "dict" dictionary in the
@@ -520,6 +649,7 @@ xmlTextReaderFreeDoc(xmlTextReaderPtr reader, xmlDocPtr cur) {
     cur->ids = NULL;
     if (cur->refs != NULL) xmlFreeRefTable((xmlRefTablePtr) cur->refs);
     cur->refs = NULL;
+    xmlDtdCacheRelease(cur);
     extSubset = cur->extSubset;
     intSubset = cur->intSubset;
     if (intSubset == extSubset)
@@ -657,6 +787,11 @@ xmlTextReaderStartElement(void *ctx, const xmlChar *fullname,
 	    (ctxt->input->cur[1] == '>'))
 	    ctxt->node->extra = NODE_IS_EMPTY;
     }
+#ifdef LIBXML_PATTERN_ENABLED
+    /* Namespaces are unknown, match with xmlPatternMatch */
+    if ((reader != NULL) && (reader->patternStream != NULL))
+        xmlTextReaderPatternFallback(reader);
+#endif
     if (reader != NULL)
 	reader->state = XML_TEXTREADER_ELEMENT;
 }
@@ -713,6 +848,10 @@ xmlTextReaderStartElementNs(void *ctx,
 	    (ctxt->input->cur != NULL) && (ctxt->input->cur[0] == '/') &&
 	    (ctxt->input->cur[1] == '>'))
 	    ctxt->node->extra = NODE_IS_EMPTY;
+#ifdef LIBXML_PATTERN_ENABLED
+        if (reader->patternStream != NULL)
+            xmlTextReaderPatternPush(reader, localname, URI);
+#endif
     }
     if (reader != NULL)
 	reader->state = XML_TEXTREADER_ELEMENT;
@@ -737,6 +876,10 @@ xmlTextReaderEndElementNs(void *ctx,
 
     if ((reader != NULL) && (reader->endElementNs != NULL)) {
 	reader->endElementNs(ctx, localname, prefix, URI);
+#ifdef LIBXML_PATTERN_ENABLED
+        if (reader->patternStream != NULL)
+            xmlTextReaderPatternPop(reader);
+#endif
     }
 }
 
@@ -1035,105 +1178,1896 @@ xmlTextReaderValidatePop(xmlTextReaderPtr reader) {
 	if (ret != 1)
 	    reader->rngValidErrors++;
     }
-#endif
+#endif
+
+    return(0);
+}
+
+/**
+ * Handle the validation when an entity reference is encountered and
+ * entity substitution is not activated. As a result the parser interface
+ * must walk through the entity and do the validation calls
+ *
+ * @param reader  the xmlTextReader used
+ */
+static int
+xmlTextReaderValidateEntity(xmlTextReaderPtr reader) {
+    xmlNodePtr oldnode = reader->node;
+    xmlNodePtr node = reader->node;
+
+    do {
+	if (node->type == XML_ENTITY_REF_NODE) {
+	    if ((node->children != NULL) &&
+		(node->children->type == XML_ENTITY_DECL) &&
+		(node->children->children != NULL)) {
+		if (xmlTextReaderEntPush(reader, node) < 0) {
+                    if (node == oldnode)
+                        break;
+                    goto skip_children;
+                }
+		node = node->children->children;
+		continue;
+	    } else {
+		/*
+		 * The error has probably been raised already.
+		 */
+		if (node == oldnode)
+		    break;
+                goto skip_children;
+	    }
+#ifdef LIBXML_REGEXP_ENABLED
+	} else if (node->type == XML_ELEMENT_NODE) {
+	    reader->node = node;
+	    if (xmlTextReaderValidatePush(reader) < 0)
+                return(-1);
+	} else if ((node->type == XML_TEXT_NODE) ||
+		   (node->type == XML_CDATA_SECTION_NODE)) {
+            xmlTextReaderValidateCData(reader, node->content,
+	                               xmlStrlen(node->content));
+#endif
+	}
+
+	/*
+	 * go to next node
+	 */
+	if (node->children != NULL) {
+	    node = node->children;
+	    continue;
+	} else if (node->type == XML_ELEMENT_NODE) {
+	    if (xmlTextReaderValidatePop(reader) < 0)
+                return(-1);
+	}
+skip_children:
+	if (node->next != NULL) {
+	    node = node->next;
+	    continue;
+	}
+	do {
+	    node = node->parent;
+	    if (node->type == XML_ELEMENT_NODE) {
+	        xmlNodePtr tmp;
+		if (reader->entNr == 0) {
+		    while ((tmp = node->last) != NULL) {
+			if ((tmp->extra & NODE_IS_PRESERVED) == 0) {
+			    xmlUnlinkNode(tmp);
+			    xmlTextReaderFreeNode(reader, tmp);
+			} else
+			    break;
+		    }
+		}
+		reader->node = node;
+		if (xmlTextReaderValidatePop(reader) < 0)
+                    return(-1);
+	    }
+	    if ((node->type == XML_ENTITY_DECL) &&
+		(reader->ent != NULL) && (reader->ent->children == node)) {
+		node = xmlTextReaderEntPop(reader);
+	    }
+	    if (node == oldnode)
+		break;
+	    if (node->next != NULL) {
+		node = node->next;
+		break;
+	    }
+	} while ((node != NULL) && (node != oldnode));
+    } while ((node != NULL) && (node != oldnode));
+    reader->node = oldnode;
+
+    return(0);
+}
+#endif /* LIBXML_REGEXP_ENABLED */
+
+
+/************************************************************************
+ *									*
+ *	Skipping subtrees without building nodes			*
+ *									*
+ ************************************************************************/
+
+/**
+ * Check whether the reader configuration can work without building
+ * every node. With preserve patterns, only subtrees which can't
+ * contain matches are optional.
+ *
+ * @param reader  the xmlTextReader used
+ * @param node  the root of the subtree to leave out, NULL for the
+ *              whole document
+ * @returns 1 if nodes can be left out, 0 otherwise
+ */
+static int
+xmlTextReaderTreeOptional(xmlTextReaderPtr reader, xmlNodePtr node) {
+    if ((reader->validate != XML_TEXTREADER_NOT_VALIDATE) ||
+        (reader->parserFlags & XML_PARSE_SAX1))
+        return(0);
+#ifdef LIBXML_XINCLUDE_ENABLED
+    if (reader->xinclude)
+        return(0);
+#endif
+#ifdef LIBXML_PATTERN_ENABLED
+    if ((reader->patternNr > 0) &&
+        ((reader->patternStream == NULL) || (node == NULL) ||
+         ((node->extra & NODE_NO_MATCH_BELOW) == 0)))
+        return(0);
+#else
+    (void) node;
+#endif
+    return(1);
+}
+
+/**
+ * Stop skipping and restore the SAX callbacks of the parser.
+ *
+ * @param reader  the xmlTextReader used
+ */
+static void
+xmlTextReaderSkipEnd(xmlTextReaderPtr reader) {
+    if (!reader->skipping)
+        return;
+
+    memcpy(reader->ctxt->sax, &reader->skipSax, sizeof(xmlSAXHandler));
+    reader->ctxt->replaceEntities = reader->skipEntities;
+    reader->skipping = 0;
+    reader->skipOpen = 0;
+    reader->skipLevel = 0;
+    reader->skipNode = NULL;
+}
+
+/*
+ * While skipping, the parser still checks well-formedness but the
+ * callbacks only track the nesting of tags. When building a tree,
+ * entities parsed for the first time have their own parent node.
+ * These events are forwarded, so that the entity content is built
+ * like without skipping.
+ */
+
+static void
+xmlTextReaderSkipStartElementNs(void *ctx,
+                                const xmlChar *localname,
+                                const xmlChar *prefix,
+                                const xmlChar *URI,
+                                int nb_namespaces,
+                                const xmlChar **namespaces,
+                                int nb_attributes,
+                                int nb_defaulted,
+                                const xmlChar **attributes)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if (ctxt->node != reader->skipNode) {
+        if (reader->skipSax.startElementNs != NULL)
+            reader->skipSax.startElementNs(ctx, localname, prefix, URI,
+                                           nb_namespaces, namespaces,
+                                           nb_attributes, nb_defaulted,
+                                           attributes);
+        return;
+    }
+
+    reader->skipLevel++;
+}
+
+static void
+xmlTextReaderSkipEndElementNs(void *ctx,
+                              const xmlChar *localname,
+                              const xmlChar *prefix,
+                              const xmlChar *URI)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if (ctxt->node != reader->skipNode) {
+        if (reader->skipSax.endElementNs != NULL)
+            reader->skipSax.endElementNs(ctx, localname, prefix, URI);
+        return;
+    }
+
+    if (reader->skipLevel > 0) {
+        reader->skipLevel--;
+        return;
+    }
+
+    /* Close an element which was opened before skipping */
+    if (reader->skipSax.endElementNs != NULL)
+        reader->skipSax.endElementNs(ctx, localname, prefix, URI);
+    reader->skipNode = ctxt->node;
+    reader->skipOpen--;
+    if (reader->skipOpen <= 0)
+        xmlTextReaderSkipEnd(reader);
+}
+
+static void
+xmlTextReaderSkipCharacters(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((ctxt->node != reader->skipNode) && (reader->skipSax.characters != NULL))
+        reader->skipSax.characters(ctx, ch, len);
+}
+
+static void
+xmlTextReaderSkipIgnorableWhitespace(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((ctxt->node != reader->skipNode) &&
+        (reader->skipSax.ignorableWhitespace != NULL))
+        reader->skipSax.ignorableWhitespace(ctx, ch, len);
+}
+
+static void
+xmlTextReaderSkipCDataBlock(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((ctxt->node != reader->skipNode) && (reader->skipSax.cdataBlock != NULL))
+        reader->skipSax.cdataBlock(ctx, ch, len);
+}
+
+static void
+xmlTextReaderSkipComment(void *ctx, const xmlChar *value)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((ctxt->node != reader->skipNode) && (reader->skipSax.comment != NULL))
+        reader->skipSax.comment(ctx, value);
+}
+
+static void
+xmlTextReaderSkipProcessingInstruction(void *ctx, const xmlChar *target,
+                                       const xmlChar *data)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((ctxt->node != reader->skipNode) &&
+        (reader->skipSax.processingInstruction != NULL))
+        reader->skipSax.processingInstruction(ctx, target, data);
+}
+
+static void
+xmlTextReaderSkipReference(void *ctx, const xmlChar *name)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((ctxt->node != reader->skipNode) && (reader->skipSax.reference != NULL))
+        reader->skipSax.reference(ctx, name);
+}
+
+/**
+ * Start dropping parser events until @open elements which are
+ * currently open in the parser are closed. In flat mode, entities
+ * aren't substituted in the meantime. When building a tree, this
+ * would leave references in the content of entities parsed for the
+ * first time.
+ *
+ * @param reader  the xmlTextReader used
+ * @param open  number of open elements to close, including the
+ *              element being skipped
+ */
+static void
+xmlTextReaderSkipStart(xmlTextReaderPtr reader, int open) {
+    xmlParserCtxtPtr ctxt = reader->ctxt;
+    xmlSAXHandlerPtr sax = ctxt->sax;
+
+    if ((reader->skipping) || (open <= 0) ||
+        (sax->initialized != XML_SAX2_MAGIC))
+        return;
+
+    memcpy(&reader->skipSax, sax, sizeof(xmlSAXHandler));
+    reader->skipEntities = ctxt->replaceEntities;
+    reader->skipping = 1;
+    reader->skipOpen = open;
+    reader->skipLevel = 0;
+    reader->skipNode = ctxt->node;
+
+    if (reader->flat)
+        ctxt->replaceEntities = 0;
+    sax->startElementNs = xmlTextReaderSkipStartElementNs;
+    sax->endElementNs = xmlTextReaderSkipEndElementNs;
+    sax->characters = xmlTextReaderSkipCharacters;
+    sax->ignorableWhitespace = xmlTextReaderSkipIgnorableWhitespace;
+    sax->cdataBlock = xmlTextReaderSkipCDataBlock;
+    sax->comment = xmlTextReaderSkipComment;
+    sax->processingInstruction = xmlTextReaderSkipProcessingInstruction;
+    sax->reference = xmlTextReaderSkipReference;
+}
+
+#ifdef LIBXML_PATTERN_ENABLED
+/**
+ * Stop matching preserve patterns while parsing. Nodes are matched
+ * with #xmlPatternMatch when they are read instead.
+ *
+ * @param reader  the xmlTextReader used
+ */
+static void
+xmlTextReaderPatternFallback(xmlTextReaderPtr reader) {
+    xmlFreePatternSetStream(reader->patternStream);
+    reader->patternStream = NULL;
+    xmlFreePatternSet(reader->patternSet);
+    reader->patternSet = NULL;
+    reader->patternDepth = 0;
+}
+
+/**
+ * Match the element just started by the parser against the preserve
+ * patterns. With pruning, the content of elements which can't
+ * contain matches is dropped right away.
+ *
+ * @param reader  the xmlTextReader used
+ * @param localname  the local name of the element
+ * @param URI  the namespace name of the element
+ */
+static void
+xmlTextReaderPatternPush(xmlTextReaderPtr reader, const xmlChar *localname,
+                         const xmlChar *URI) {
+    xmlParserCtxtPtr ctxt = reader->ctxt;
+    xmlNodePtr node = ctxt->node;
+    int match, below;
+
+    /*
+     * Entity content is parsed once and copied for later references,
+     * so the copies would never be matched.
+     */
+    if ((ctxt->inputNr > 1) || (node == NULL) ||
+        (node->type != XML_ELEMENT_NODE)) {
+        xmlTextReaderPatternFallback(reader);
+        return;
+    }
+
+    match = xmlPatternSetPush(reader->patternStream, localname, URI, NULL);
+    if (match < 0) {
+        xmlTextReaderErrMemory(reader);
+        xmlTextReaderPatternFallback(reader);
+        return;
+    }
+    below = xmlPatternSetWantsDescendants(reader->patternStream);
+
+    if (match > 0)
+        node->extra |= NODE_IS_MATCHED;
+    if (!below)
+        node->extra |= NODE_NO_MATCH_BELOW;
+
+    /* Matched subtrees are preserved as a whole */
+    if (reader->patternDepth > 0)
+        reader->patternDepth++;
+    else if (match > 0)
+        reader->patternDepth = 1;
+    else if ((reader->patternPrune) && (!below) &&
+             (xmlTextReaderTreeOptional(reader, node)))
+        xmlTextReaderSkipStart(reader, 1);
+}
+
+/**
+ * Pop the element just ended by the parser from the preserve
+ * patterns.
+ *
+ * @param reader  the xmlTextReader used
+ */
+static void
+xmlTextReaderPatternPop(xmlTextReaderPtr reader) {
+    xmlPatternSetPop(reader->patternStream);
+    if (reader->patternDepth > 0)
+        reader->patternDepth--;
+}
+#endif /* LIBXML_PATTERN_ENABLED */
+
+/************************************************************************
+ *									*
+ *	Flat mode: exposing parser events without building a tree	*
+ *									*
+ ************************************************************************/
+
+/**
+ * Events from entity content are only reported if entities are
+ * substituted. Otherwise, the reference is reported.
+ *
+ * @param ctxt  the parser context
+ * @returns 1 if the current event must be ignored
+ */
+static int
+xmlTextReaderFlatSkip(xmlParserCtxtPtr ctxt) {
+    return((ctxt->replaceEntities == 0) && (ctxt->inputNr > 1));
+}
+
+/**
+ * Report a memory error from the SAX callbacks in flat mode. In
+ * pipelined mode, the reader state belongs to the reader thread, the
+ * error stops the parser which is reported when the queue is drained.
+ *
+ * @param reader  the xmlTextReader used
+ */
+static void
+xmlTextReaderFlatErrMemory(xmlTextReaderPtr reader) {
+    if (reader->pipe != NULL)
+        xmlCtxtErrMemory(reader->ctxt);
+    else
+        xmlTextReaderErrMemory(reader);
+}
+
+/**
+ * Queue a new event.
+ *
+ * @param reader  the xmlTextReader used
+ * @param type  the node type of the event
+ * @returns the new event or NULL if a memory allocation failed
+ */
+static xmlTextReaderFlatEvent *
+xmlTextReaderFlatPush(xmlTextReaderPtr reader, xmlElementType type) {
+    xmlTextReaderFlatQueue *q = reader->flatFill;
+    xmlTextReaderFlatEvent *ev;
+
+    if (q->nr >= q->max) {
+        xmlTextReaderFlatEvent *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(q->max, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            xmlTextReaderFlatErrMemory(reader);
+            return(NULL);
+        }
+        tmp = xmlRealloc(q->tab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlTextReaderFlatErrMemory(reader);
+            return(NULL);
+        }
+        q->tab = tmp;
+        q->max = newSize;
+    }
+
+    ev = &q->tab[q->nr++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->depth = reader->flatDepth;
+    ev->content = -1;
+
+    reader->flatEmpty = 0;
+    /* Stops xmlTextReaderPushData */
+    if (reader->pipe == NULL)
+        reader->state = XML_TEXTREADER_ELEMENT;
+
+    return(ev);
+}
+
+/**
+ * Make room for `len` more bytes of event content.
+ *
+ * @param reader  the xmlTextReader used
+ * @param len  the number of bytes
+ * @returns 0 on success, -1 if a memory allocation failed
+ */
+static int
+xmlTextReaderFlatGrowText(xmlTextReaderPtr reader, int len) {
+    xmlTextReaderFlatQueue *q = reader->flatFill;
+    xmlChar *tmp;
+    int newSize;
+
+    if (len <= q->textMax - q->textNr)
+        return(0);
+
+    if (len > XML_MAX_ITEMS - q->textNr)
+        goto error;
+    newSize = q->textMax;
+    do {
+        newSize = xmlGrowCapacity(newSize, 1, 256, XML_MAX_ITEMS);
+        if (newSize < 0)
+            goto error;
+    } while (newSize - q->textNr < len);
+
+    tmp = xmlRealloc(q->text, newSize);
+    if (tmp == NULL)
+        goto error;
+    q->text = tmp;
+    q->textMax = newSize;
+    return(0);
+
+error:
+    xmlTextReaderFlatErrMemory(reader);
+    return(-1);
+}
+
+/**
+ * Copy a string to the event content.
+ *
+ * @param reader  the xmlTextReader used
+ * @param str  the string
+ * @param len  the length of the string
+ * @returns the offset of the copy or -1 if a memory allocation failed
+ */
+static int
+xmlTextReaderFlatCopy(xmlTextReaderPtr reader, const xmlChar *str, int len) {
+    xmlTextReaderFlatQueue *q = reader->flatFill;
+    int offset;
+
+    if (xmlTextReaderFlatGrowText(reader, len + 1) < 0)
+        return(-1);
+    offset = q->textNr;
+    if (len > 0)
+        memcpy(&q->text[offset], str, len);
+    q->text[offset + len] = 0;
+    q->textNr += len + 1;
+
+    return(offset);
+}
+
+/**
+ * Queue text or a CDATA section. Text is merged with text queued
+ * just before.
+ *
+ * @param reader  the xmlTextReader used
+ * @param type  XML_TEXT_NODE or XML_CDATA_SECTION_NODE
+ * @param ch  the content
+ * @param len  the length of the content
+ */
+static void
+xmlTextReaderFlatAddText(xmlTextReaderPtr reader, xmlElementType type,
+                         const xmlChar *ch, int len) {
+    xmlTextReaderFlatQueue *q = reader->flatFill;
+    xmlTextReaderFlatEvent *ev;
+
+    /* In pipelined mode, the reader doesn't see the filled queue yet */
+    if ((type == XML_TEXT_NODE) && (q->nr > 0) &&
+        ((reader->pipe != NULL) || (q->nr > reader->flatCur + 1))) {
+        ev = &q->tab[q->nr - 1];
+
+        if (ev->type == XML_TEXT_NODE) {
+            xmlParserCtxtPtr ctxt = reader->ctxt;
+            int maxSize = (ctxt->options & XML_PARSE_HUGE) ?
+                          XML_MAX_HUGE_LENGTH :
+                          XML_MAX_TEXT_LENGTH;
+
+            if ((len > maxSize) || (ev->contentLen > maxSize - len)) {
+                xmlFatalErr(ctxt, XML_ERR_RESOURCE_LIMIT,
+                            "Text node too long, try XML_PARSE_HUGE");
+                return;
+            }
+            if (xmlTextReaderFlatGrowText(reader, len) < 0)
+                return;
+
+            /* The content of the last event is at the end */
+            memcpy(&q->text[q->textNr - 1], ch, len);
+            q->textNr += len;
+            q->text[q->textNr - 1] = 0;
+            ev->contentLen += len;
+            return;
+        }
+    }
+
+    ev = xmlTextReaderFlatPush(reader, type);
+    if (ev == NULL)
+        return;
+    ev->content = xmlTextReaderFlatCopy(reader, ch, len);
+    ev->contentLen = len;
+}
+
+/**
+ * Copy an attribute value to the event content.
+ *
+ * @param reader  the xmlTextReader used
+ * @param attr  the attribute
+ * @param value  start of the value
+ * @param valueend  end of the value
+ * @returns 0 on success, -1 if a memory allocation failed
+ */
+static int
+xmlTextReaderFlatValue(xmlTextReaderPtr reader, xmlTextReaderFlatAttr *attr,
+                       const xmlChar *value, const xmlChar *valueend) {
+    xmlParserCtxtPtr ctxt = reader->ctxt;
+    int len = valueend - value;
+
+    /*
+     * If entities aren't substituted, references are kept in the
+     * value, see xmlSAX2AttributeNs. Entity content isn't built in
+     * flat mode, so expand from the replacement text.
+     */
+    if ((ctxt->replaceEntities == 0) && (*valueend == 0) &&
+        (memchr(value, '&', len) != NULL)) {
+        xmlChar *str;
+
+        str = xmlExpandEntitiesInAttValue(ctxt, value, /* normalize */ 0);
+        if (str == NULL)
+            goto mem_error;
+
+        len = xmlStrlen(str);
+        attr->value = xmlTextReaderFlatCopy(reader, str, len);
+        xmlFree(str);
+    } else {
+        attr->value = xmlTextReaderFlatCopy(reader, value, len);
+    }
+    attr->valueLen = len;
+
+    return((attr->value < 0) ? -1 : 0);
+
+mem_error:
+    xmlTextReaderFlatErrMemory(reader);
+    return(-1);
+}
+
+static void
+xmlTextReaderFlatStartElementNs(void *ctx,
+                                const xmlChar *localname,
+                                const xmlChar *prefix,
+                                const xmlChar *URI,
+                                int nb_namespaces,
+                                const xmlChar **namespaces,
+                                int nb_attributes,
+                                int nb_defaulted,
+                                const xmlChar **attributes)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+    xmlTextReaderFlatEvent *ev;
+    xmlTextReaderFlatAttr *attr;
+    xmlTextReaderFlatQueue *q;
+    int empty, nb, i;
+
+    if ((reader == NULL) || (xmlTextReaderFlatSkip(ctxt)))
+        return;
+
+    empty = ((ctxt->input != NULL) && (ctxt->input->cur != NULL) &&
+             (ctxt->input->cur[0] == '/') && (ctxt->input->cur[1] == '>'));
+
+    /* Undeclared prefixes are kept in the name like xmlSAX2StartElementNs */
+    if ((prefix != NULL) && (URI == NULL)) {
+        localname = xmlDictQLookup(ctxt->dict, prefix, localname);
+        if (localname == NULL) {
+            xmlTextReaderFlatErrMemory(reader);
+            return;
+        }
+    }
+
+    ev = xmlTextReaderFlatPush(reader, XML_ELEMENT_NODE);
+    if (ev == NULL)
+        return;
+    ev->name = localname;
+    ev->prefix = prefix;
+    ev->URI = URI;
+    if (empty)
+        ev->flags = XML_TEXTREADER_FLAT_EMPTY;
+    reader->flatDepth++;
+
+    /* Like xmlSAX2StartElementNs */
+    if ((nb_defaulted != 0) &&
+        ((ctxt->loadsubset & XML_COMPLETE_ATTRS) == 0))
+        nb_attributes -= nb_defaulted;
+
+    q = reader->flatFill;
+    nb = nb_namespaces + nb_attributes;
+    if (nb > q->attrMax - q->attrNr) {
+        xmlTextReaderFlatAttr *tmp;
+        int newSize = q->attrMax;
+
+        do {
+            newSize = xmlGrowCapacity(newSize, sizeof(tmp[0]), 16,
+                                      XML_MAX_ITEMS);
+            if (newSize < 0) {
+                xmlTextReaderFlatErrMemory(reader);
+                return;
+            }
+        } while (newSize - q->attrNr < nb);
+        tmp = xmlRealloc(q->attrTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlTextReaderFlatErrMemory(reader);
+            return;
+        }
+        q->attrTab = tmp;
+        q->attrMax = newSize;
+    }
+
+    ev->attrs = q->attrNr;
+    for (i = 0; i < nb_namespaces; i++) {
+        attr = &q->attrTab[q->attrNr++];
+        attr->name = namespaces[2 * i];
+        attr->prefix = NULL;
+        attr->URI = namespaces[2 * i + 1];
+        attr->value = -1;
+        attr->valueLen = 0;
+        ev->nbNs++;
+    }
+    for (i = 0; i < nb_attributes * 5; i += 5) {
+        attr = &q->attrTab[q->attrNr++];
+        attr->name = attributes[i];
+        attr->prefix = attributes[i + 1];
+        attr->URI = attributes[i + 2];
+        if ((attr->prefix != NULL) && (attr->URI == NULL)) {
+            attr->name = xmlDictQLookup(ctxt->dict, attr->prefix, attr->name);
+            if (attr->name == NULL) {
+                xmlTextReaderFlatErrMemory(reader);
+                return;
+            }
+        }
+        if (xmlTextReaderFlatValue(reader, attr, attributes[i + 3],
+                                   attributes[i + 4]) < 0)
+            return;
+        ev->nbAttrs++;
+    }
+
+    reader->flatEmpty = empty;
+}
+
+static void
+xmlTextReaderFlatEndElementNs(void *ctx,
+                              const xmlChar *localname,
+                              const xmlChar *prefix,
+                              const xmlChar *URI)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+    xmlTextReaderFlatEvent *ev;
+
+    if ((reader == NULL) || (xmlTextReaderFlatSkip(ctxt)))
+        return;
+
+    reader->flatDepth--;
+    /* Empty elements have no end event */
+    if (reader->flatEmpty) {
+        reader->flatEmpty = 0;
+        return;
+    }
+
+    ev = xmlTextReaderFlatPush(reader, XML_ELEMENT_NODE);
+    if (ev == NULL)
+        return;
+    ev->flags = XML_TEXTREADER_FLAT_END;
+    ev->name = localname;
+    ev->prefix = prefix;
+    ev->URI = URI;
+}
+
+static void
+xmlTextReaderFlatCharacters(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((reader == NULL) || (reader->flatDepth <= 0) ||
+        (xmlTextReaderFlatSkip(ctxt)))
+        return;
+
+    xmlTextReaderFlatAddText(reader, XML_TEXT_NODE, ch, len);
+}
+
+static void
+xmlTextReaderFlatCDataBlock(void *ctx, const xmlChar *ch, int len)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    if ((reader == NULL) || (reader->flatDepth <= 0) ||
+        (xmlTextReaderFlatSkip(ctxt)))
+        return;
+
+    xmlTextReaderFlatAddText(reader, XML_CDATA_SECTION_NODE, ch, len);
+}
+
+static void
+xmlTextReaderFlatComment(void *ctx, const xmlChar *value)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+    xmlTextReaderFlatEvent *ev;
+
+    /* Comments in the DTD are part of the DTD node */
+    if (ctxt->inSubset) {
+        xmlSAX2Comment(ctx, value);
+        return;
+    }
+    if ((reader == NULL) || (value == NULL) || (xmlTextReaderFlatSkip(ctxt)))
+        return;
+
+    ev = xmlTextReaderFlatPush(reader, XML_COMMENT_NODE);
+    if (ev == NULL)
+        return;
+    ev->contentLen = xmlStrlen(value);
+    ev->content = xmlTextReaderFlatCopy(reader, value, ev->contentLen);
+}
+
+static void
+xmlTextReaderFlatProcessingInstruction(void *ctx, const xmlChar *target,
+                                       const xmlChar *data)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+    xmlTextReaderFlatEvent *ev;
+
+    if (ctxt->inSubset) {
+        xmlSAX2ProcessingInstruction(ctx, target, data);
+        return;
+    }
+    if ((reader == NULL) || (xmlTextReaderFlatSkip(ctxt)))
+        return;
+
+    ev = xmlTextReaderFlatPush(reader, XML_PI_NODE);
+    if (ev == NULL)
+        return;
+    ev->name = xmlDictLookup(ctxt->dict, target, -1);
+    if (ev->name == NULL)
+        xmlTextReaderFlatErrMemory(reader);
+    if (data != NULL) {
+        ev->contentLen = xmlStrlen(data);
+        ev->content = xmlTextReaderFlatCopy(reader, data, ev->contentLen);
+    }
+}
+
+static void
+xmlTextReaderFlatReference(void *ctx, const xmlChar *name)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+    xmlTextReaderFlatEvent *ev;
+
+    if ((reader == NULL) || (reader->flatDepth <= 0) ||
+        (xmlTextReaderFlatSkip(ctxt)))
+        return;
+
+    ev = xmlTextReaderFlatPush(reader, XML_ENTITY_REF_NODE);
+    if (ev == NULL)
+        return;
+    ev->name = xmlDictLookup(ctxt->dict, name, -1);
+    if (ev->name == NULL)
+        xmlTextReaderFlatErrMemory(reader);
+}
+
+static void
+xmlTextReaderFlatInternalSubset(void *ctx, const xmlChar *name,
+                                const xmlChar *ExternalID,
+                                const xmlChar *SystemID)
+{
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr) ctx;
+    xmlTextReaderPtr reader = ctxt->_private;
+
+    /* The DTD is still built, the event exposes it */
+    xmlSAX2InternalSubset(ctx, name, ExternalID, SystemID);
+    if ((reader == NULL) || (ctxt->myDoc == NULL) ||
+        (ctxt->myDoc->intSubset == NULL))
+        return;
+
+    xmlTextReaderFlatPush(reader, XML_DTD_NODE);
+}
+
+/**
+ * Switch the SAX callbacks of the parser between tree building and
+ * event queueing.
+ *
+ * @param reader  the xmlTextReader used
+ * @param flat  whether to queue events
+ */
+static void
+xmlTextReaderFlatHandlers(xmlTextReaderPtr reader, int flat) {
+    xmlSAXHandlerPtr sax = reader->ctxt->sax;
+
+    if (flat) {
+        sax->startElementNs = xmlTextReaderFlatStartElementNs;
+        sax->endElementNs = xmlTextReaderFlatEndElementNs;
+        sax->characters = xmlTextReaderFlatCharacters;
+        if (sax->ignorableWhitespace == xmlTextReaderCharacters)
+            sax->ignorableWhitespace = xmlTextReaderFlatCharacters;
+        sax->cdataBlock = xmlTextReaderFlatCDataBlock;
+        sax->comment = xmlTextReaderFlatComment;
+        sax->processingInstruction = xmlTextReaderFlatProcessingInstruction;
+        sax->reference = xmlTextReaderFlatReference;
+        sax->internalSubset = xmlTextReaderFlatInternalSubset;
+    } else {
+        sax->startElementNs = xmlTextReaderStartElementNs;
+        sax->endElementNs = xmlTextReaderEndElementNs;
+        sax->characters = xmlTextReaderCharacters;
+        if (sax->ignorableWhitespace == xmlTextReaderFlatCharacters)
+            sax->ignorableWhitespace = xmlTextReaderCharacters;
+        sax->cdataBlock = xmlTextReaderCDataBlock;
+        sax->comment = xmlSAX2Comment;
+        sax->processingInstruction = xmlSAX2ProcessingInstruction;
+        sax->reference = xmlSAX2Reference;
+        sax->internalSubset = xmlSAX2InternalSubset;
+    }
+}
+
+/**
+ * Free the subtree built by xmlTextReaderExpand in flat mode.
+ *
+ * @param reader  the xmlTextReader used
+ */
+static void
+xmlTextReaderFlatFreeTree(xmlTextReaderPtr reader) {
+    if (reader->flatTree == NULL)
+        return;
+
+    if (reader->node == reader->flatTree) {
+        reader->node = NULL;
+        reader->curnode = NULL;
+    }
+    /* The parent is an element exposed by the reader */
+    reader->flatTree->parent = NULL;
+    xmlFreeNode(reader->flatTree);
+    reader->flatTree = NULL;
+}
+
+/**
+ * Return the document of the nodes exposed in flat mode. In pipelined
+ * mode, the parsed document and its dictionary belong to the parser
+ * thread, so the reader uses its own.
+ *
+ * @param reader  the xmlTextReader used
+ * @returns the document
+ */
+static xmlDocPtr
+xmlTextReaderFlatDoc(xmlTextReaderPtr reader) {
+#ifdef XML_TEXTREADER_PIPELINE
+    if (reader->pipe != NULL)
+        return(reader->pipe->doc);
+#endif
+    return(reader->ctxt->myDoc);
+}
+
+#ifdef XML_TEXTREADER_PIPELINE
+/**
+ * Append queued events to another queue.
+ *
+ * @param to  the queue to append to
+ * @param from  the queue to append
+ * @returns 0 on success, -1 if a memory allocation failed
+ */
+static int
+xmlTextReaderFlatAppend(xmlTextReaderFlatQueue *to,
+                        xmlTextReaderFlatQueue *from) {
+    int newSize, i;
+
+    if (from->nr > to->max - to->nr) {
+        xmlTextReaderFlatEvent *tmp;
+
+        newSize = to->max;
+        do {
+            newSize = xmlGrowCapacity(newSize, sizeof(tmp[0]), 16,
+                                      XML_MAX_ITEMS);
+            if (newSize < 0)
+                return(-1);
+        } while (newSize - to->nr < from->nr);
+        tmp = xmlRealloc(to->tab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        to->tab = tmp;
+        to->max = newSize;
+    }
+    if (from->attrNr > to->attrMax - to->attrNr) {
+        xmlTextReaderFlatAttr *tmp;
+
+        newSize = to->attrMax;
+        do {
+            newSize = xmlGrowCapacity(newSize, sizeof(tmp[0]), 16,
+                                      XML_MAX_ITEMS);
+            if (newSize < 0)
+                return(-1);
+        } while (newSize - to->attrNr < from->attrNr);
+        tmp = xmlRealloc(to->attrTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        to->attrTab = tmp;
+        to->attrMax = newSize;
+    }
+    if (from->textNr > to->textMax - to->textNr) {
+        xmlChar *tmp;
+
+        newSize = to->textMax;
+        do {
+            newSize = xmlGrowCapacity(newSize, 1, 256, XML_MAX_ITEMS);
+            if (newSize < 0)
+                return(-1);
+        } while (newSize - to->textNr < from->textNr);
+        tmp = xmlRealloc(to->text, newSize);
+        if (tmp == NULL)
+            return(-1);
+        to->text = tmp;
+        to->textMax = newSize;
+    }
+
+    for (i = 0; i < from->nr; i++) {
+        xmlTextReaderFlatEvent *ev = &to->tab[to->nr + i];
+
+        *ev = from->tab[i];
+        ev->attrs += to->attrNr;
+        if (ev->content >= 0)
+            ev->content += to->textNr;
+    }
+    for (i = 0; i < from->attrNr; i++) {
+        xmlTextReaderFlatAttr *attr = &to->attrTab[to->attrNr + i];
+
+        *attr = from->attrTab[i];
+        if (attr->value >= 0)
+            attr->value += to->textNr;
+    }
+    if (from->textNr > 0)
+        memcpy(&to->text[to->textNr], from->text, from->textNr);
+
+    to->nr += from->nr;
+    to->attrNr += from->attrNr;
+    to->textNr += from->textNr;
+
+    return(0);
+}
+
+/**
+ * Hand the queue filled by the parser thread to the reader and
+ * continue with a drained one. Unless parsing is finished, this only
+ * happens once enough events were queued and the last one is
+ * complete.
+ *
+ * @param reader  the xmlTextReader used
+ * @param finished  whether parsing is finished
+ * @param result  0 or -1 if parsing failed
+ * @returns 0 on success, -1 if the reader asked to stop
+ */
+static int
+xmlTextReaderPipeHandOff(xmlTextReaderPtr reader, int finished, int result) {
+    xmlTextReaderPipe *pipe = reader->pipe;
+    xmlTextReaderFlatQueue *q = reader->flatFill;
+    int ret;
+
+    /* Text might continue in the next chunk */
+    if ((!finished) &&
+        ((q->nr < XML_TEXTREADER_PIPE_BATCH) ||
+         (q->tab[q->nr - 1].type == XML_TEXT_NODE)))
+        return(0);
+
+    pthread_mutex_lock(&pipe->lock);
+    while ((pipe->ready != NULL) && (!pipe->stop))
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
+    if (!pipe->stop) {
+        if (q->nr > 0)
+            pipe->ready = q;
+        if (finished) {
+            pipe->done = 1;
+            pipe->result = result;
+        }
+        pthread_cond_broadcast(&pipe->cond);
+
+        if ((!finished) && (q->nr > 0)) {
+            while ((pipe->free == NULL) && (!pipe->stop))
+                pthread_cond_wait(&pipe->cond, &pipe->lock);
+            reader->flatFill = pipe->free;
+            pipe->free = NULL;
+        }
+    }
+    ret = pipe->stop ? -1 : 0;
+    pthread_mutex_unlock(&pipe->lock);
+
+    return(ret);
+}
+
+/**
+ * Main function of the parser thread. Parses the whole input like
+ * xmlTextReaderPushData, handing batches of events to the reader.
+ *
+ * @param data  the xmlTextReader used
+ * @returns NULL
+ */
+static void *
+xmlTextReaderPipeMain(void *data) {
+    xmlTextReaderPtr reader = data;
+    xmlParserCtxtPtr ctxt = reader->ctxt;
+    xmlBufPtr inbuf = reader->input->buffer;
+    int eof = 0, terminate = 0, result = 0;
+    int val, len;
+
+    while (1) {
+        if ((!eof) &&
+            (xmlBufUse(inbuf) - reader->cur < XML_TEXTREADER_PIPE_CHUNK)) {
+            val = xmlParserInputBufferRead(reader->input,
+                                           XML_TEXTREADER_PIPE_CHUNK);
+            if (val < 0) {
+                xmlCtxtErrIO(ctxt, reader->input->error, NULL);
+                result = -1;
+                break;
+            }
+            if (val == 0)
+                eof = 1;
+        }
+
+        /* Memory input is available at once, parse it in chunks too */
+        len = xmlBufUse(inbuf) - reader->cur;
+        if (len > XML_TEXTREADER_PIPE_CHUNK)
+            len = XML_TEXTREADER_PIPE_CHUNK;
+        else if (eof)
+            terminate = 1;
+        val = xmlParseChunk(ctxt,
+                (const char *) xmlBufContent(inbuf) + reader->cur, len,
+                terminate);
+        reader->cur += len;
+        if ((val != 0) || (ctxt->wellFormed == 0)) {
+            result = -1;
+            break;
+        }
+        if (terminate)
+            break;
+
+        if (reader->cur > 80 /* LINE_LEN */) {
+            val = xmlBufShrink(inbuf, reader->cur - 80);
+            if (val >= 0)
+                reader->cur -= val;
+        }
+
+        if (xmlTextReaderPipeHandOff(reader, 0, 0) < 0)
+            return(NULL);
+    }
+
+    xmlTextReaderPipeHandOff(reader, 1, result);
+    return(NULL);
+}
+
+/**
+ * Start the parser thread. Exposed nodes use a separate document
+ * and strings are interned in a separate dictionary.
+ *
+ * @param reader  the xmlTextReader used
+ * @returns 0 on success, -1 if the thread couldn't be started
+ */
+static int
+xmlTextReaderPipeStart(xmlTextReaderPtr reader) {
+    xmlParserCtxtPtr ctxt = reader->ctxt;
+    xmlTextReaderPipe *pipe;
+    xmlDictPtr dict;
+
+    if ((reader->input == NULL) || (reader->input->buffer == NULL))
+        return(-1);
+
+    pipe = xmlMalloc(sizeof(*pipe));
+    if (pipe == NULL)
+        return(-1);
+    memset(pipe, 0, sizeof(*pipe));
+    pipe->doc = xmlNewDoc(NULL);
+    dict = xmlDictCreate();
+    if ((pipe->doc == NULL) || (dict == NULL))
+        goto error;
+    pipe->doc->dict = dict;
+    xmlDictReference(dict);
+    if ((ctxt->input != NULL) && (ctxt->input->filename != NULL)) {
+        pipe->doc->URL = xmlStrdup(BAD_CAST ctxt->input->filename);
+        if (pipe->doc->URL == NULL)
+            goto error;
+    }
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+
+    reader->flatQ = &reader->flatQueues[0];
+    reader->flatFill = &reader->flatQueues[1];
+    pipe->free = &reader->flatQueues[2];
+    reader->pipe = pipe;
+    if (pthread_create(&pipe->thread, NULL, xmlTextReaderPipeMain,
+                       reader) != 0) {
+        reader->pipe = NULL;
+        reader->flatFill = reader->flatQ;
+        pthread_cond_destroy(&pipe->cond);
+        pthread_mutex_destroy(&pipe->lock);
+        goto error;
+    }
+
+    if (reader->dict != ctxt->dict)
+        xmlDictFree(reader->dict);
+    reader->dict = dict;
+
+    return(0);
+
+error:
+    xmlDictFree(dict);
+    xmlFreeDoc(pipe->doc);
+    xmlFree(pipe);
+    return(-1);
+}
+
+/**
+ * Get the next queue filled by the parser thread. If events are still
+ * queued, the new events are appended.
+ *
+ * @param reader  the xmlTextReader used
+ * @returns 1 if events were added, 0 at the end of the document or -1
+ *          in case of error
+ */
+static int
+xmlTextReaderPipeTake(xmlTextReaderPtr reader) {
+    xmlTextReaderPipe *pipe = reader->pipe;
+    xmlTextReaderFlatQueue *ready, *drained;
+    int ret = 1;
+
+    pthread_mutex_lock(&pipe->lock);
+    while ((pipe->ready == NULL) && (!pipe->done))
+        pthread_cond_wait(&pipe->cond, &pipe->lock);
+    ready = pipe->ready;
+    pipe->ready = NULL;
+    if (ready == NULL)
+        ret = (pipe->result < 0) ? -1 : 0;
+    pthread_mutex_unlock(&pipe->lock);
+
+    if (ready == NULL)
+        return(ret);
+
+    if (reader->flatQ->nr == 0) {
+        drained = reader->flatQ;
+        reader->flatQ = ready;
+    } else {
+        if (xmlTextReaderFlatAppend(reader->flatQ, ready) < 0) {
+            xmlTextReaderErrMemory(reader);
+            ret = -1;
+        }
+        drained = ready;
+    }
+    drained->nr = 0;
+    drained->attrNr = 0;
+    drained->textNr = 0;
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->free = drained;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+
+    return(ret);
+}
+#endif /* XML_TEXTREADER_PIPELINE */
+
+/**
+ * Stop the parser thread of pipelined mode.
+ *
+ * @param reader  the xmlTextReader used
+ */
+static void
+xmlTextReaderPipeStop(xmlTextReaderPtr reader) {
+#ifdef XML_TEXTREADER_PIPELINE
+    xmlTextReaderPipe *pipe = reader->pipe;
+
+    if (pipe == NULL)
+        return;
+
+    pthread_mutex_lock(&pipe->lock);
+    pipe->stop = 1;
+    pthread_cond_broadcast(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+    pthread_join(pipe->thread, NULL);
+
+    pthread_cond_destroy(&pipe->cond);
+    pthread_mutex_destroy(&pipe->lock);
+    xmlFreeDoc(pipe->doc);
+    xmlFree(pipe);
+    reader->pipe = NULL;
+    reader->flatFill = reader->flatQ;
+#else
+    (void) reader;
+#endif
+}
+
+/**
+ * Queue more events in flat mode.
+ *
+ * @param reader  the xmlTextReader used
+ * @returns 1 if events may have been added, 0 at the end of the
+ *          document or -1 in case of error
+ */
+static int
+xmlTextReaderFlatMore(xmlTextReaderPtr reader) {
+#ifdef XML_TEXTREADER_PIPELINE
+    if (reader->pipe != NULL) {
+        int ret = xmlTextReaderPipeTake(reader);
+
+        if (ret == 0)
+            reader->mode = XML_TEXTREADER_MODE_EOF;
+        return(ret);
+    }
+#endif
+
+    if ((reader->mode == XML_TEXTREADER_MODE_EOF) ||
+        (PARSER_STOPPED(reader->ctxt)))
+        return(0);
+    if (xmlTextReaderPushData(reader) < 0)
+        return(-1);
+    return(1);
+}
+
+/**
+ * Free the buffers of flat mode.
+ *
+ * @param reader  the xmlTextReader used
+ */
+static void
+xmlTextReaderFlatFree(xmlTextReaderPtr reader) {
+    int i;
+
+    xmlTextReaderFlatFreeTree(reader);
+    xmlTextReaderPipeStop(reader);
+    for (i = 0; i < reader->flatElemMax; i++) {
+        xmlTextReaderFlatElem *elem = reader->flatElemTab[i];
+
+        if (elem == NULL)
+            continue;
+        xmlFree(elem->nsTab);
+        xmlFree(elem->attrTab);
+        xmlFree(elem->textTab);
+        xmlFree(elem->values);
+        xmlFree(elem);
+    }
+    xmlFree(reader->flatElemTab);
+    for (i = 0; i < 3; i++) {
+        xmlFree(reader->flatQueues[i].tab);
+        xmlFree(reader->flatQueues[i].attrTab);
+        xmlFree(reader->flatQueues[i].text);
+    }
+}
+
+/**
+ * Return the element exposed at `depth`, creating it if needed.
+ *
+ * @param reader  the xmlTextReader used
+ * @param depth  the depth of the element
+ * @returns the element or NULL if a memory allocation failed
+ */
+static xmlTextReaderFlatElem *
+xmlTextReaderFlatGetElem(xmlTextReaderPtr reader, int depth) {
+    xmlTextReaderFlatElem *elem;
+
+    if (depth >= reader->flatElemMax) {
+        xmlTextReaderFlatElem **tmp;
+        int newSize = reader->flatElemMax;
+
+        do {
+            newSize = xmlGrowCapacity(newSize, sizeof(tmp[0]), 16,
+                                      XML_MAX_ITEMS);
+            if (newSize < 0)
+                goto mem_error;
+        } while (newSize <= depth);
+        tmp = xmlRealloc(reader->flatElemTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto mem_error;
+        memset(&tmp[reader->flatElemMax], 0,
+               (newSize - reader->flatElemMax) * sizeof(tmp[0]));
+        reader->flatElemTab = tmp;
+        reader->flatElemMax = newSize;
+    }
+
+    elem = reader->flatElemTab[depth];
+    if (elem == NULL) {
+        elem = xmlMalloc(sizeof(*elem));
+        if (elem == NULL)
+            goto mem_error;
+        memset(elem, 0, sizeof(*elem));
+        reader->flatElemTab[depth] = elem;
+    }
+
+    return(elem);
+
+mem_error:
+    xmlTextReaderErrMemory(reader);
+    return(NULL);
+}
+
+/**
+ * Return a namespace of an exposed element, reusing its declarations.
+ *
+ * @param elem  the exposed element
+ * @param nbDefs  the number of namespace declarations
+ * @param nsNr  the number of used namespaces, updated
+ * @param prefix  the namespace prefix
+ * @param URI  the namespace name
+ * @returns the namespace
+ */
+static xmlNsPtr
+xmlTextReaderFlatNs(xmlTextReaderFlatElem *elem, int nbDefs, int *nsNr,
+                    const xmlChar *prefix, const xmlChar *URI) {
+    xmlNsPtr ns;
+    int i;
+
+    for (i = 0; i < nbDefs; i++) {
+        ns = &elem->nsTab[i];
+        if ((ns->prefix == prefix) && (ns->href == URI))
+            return(ns);
+    }
+
+    ns = &elem->nsTab[(*nsNr)++];
+    memset(ns, 0, sizeof(*ns));
+    ns->type = XML_NAMESPACE_DECL;
+    ns->href = URI;
+    ns->prefix = prefix;
+    ns->context = elem->node.doc;
+
+    return(ns);
+}
+
+/**
+ * Expose a start tag through the element of its depth. Names are
+ * shared with the parser dictionary, only attribute values are copied
+ * since they must survive until the end tag for xml:lang and xml:space
+ * lookups.
+ *
+ * @param reader  the xmlTextReader used
+ * @param ev  the event
+ * @returns 0 on success, -1 if a memory allocation failed
+ */
+static int
+xmlTextReaderFlatElement(xmlTextReaderPtr reader, xmlTextReaderFlatEvent *ev) {
+    xmlTextReaderFlatElem *elem;
+    xmlTextReaderFlatAttr *attrs;
+    xmlDocPtr doc = xmlTextReaderFlatDoc(reader);
+    xmlNodePtr node;
+    int size, nsNr, offset, i;
+
+    elem = xmlTextReaderFlatGetElem(reader, ev->depth);
+    if (elem == NULL)
+        return(-1);
+    attrs = &reader->flatQ->attrTab[ev->attrs];
+
+    /* Declarations, then the namespaces of the element and attributes */
+    size = ev->nbNs + ev->nbAttrs + 1;
+    if (size > elem->nsMax) {
+        xmlNsPtr tmp;
+
+        tmp = xmlRealloc(elem->nsTab, size * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto mem_error;
+        elem->nsTab = tmp;
+        elem->nsMax = size;
+    }
+    if (ev->nbAttrs > elem->attrMax) {
+        xmlAttrPtr tmp;
+        xmlNodePtr text;
+
+        tmp = xmlRealloc(elem->attrTab, ev->nbAttrs * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto mem_error;
+        elem->attrTab = tmp;
+        text = xmlRealloc(elem->textTab, ev->nbAttrs * sizeof(text[0]));
+        if (text == NULL)
+            goto mem_error;
+        elem->textTab = text;
+        elem->attrMax = ev->nbAttrs;
+    }
+    size = 0;
+    for (i = 0; i < ev->nbAttrs; i++)
+        size += attrs[ev->nbNs + i].valueLen + 1;
+    if (size > elem->valuesMax) {
+        xmlChar *tmp;
+
+        tmp = xmlRealloc(elem->values, size);
+        if (tmp == NULL)
+            goto mem_error;
+        elem->values = tmp;
+        elem->valuesMax = size;
+    }
+
+    node = &elem->node;
+    memset(node, 0, sizeof(*node));
+    node->type = XML_ELEMENT_NODE;
+    node->name = ev->name;
+    node->doc = doc;
+    if (ev->depth > 0)
+        node->parent = &reader->flatElemTab[ev->depth - 1]->node;
+    else
+        node->parent = (xmlNodePtr) doc;
+    if (ev->flags & XML_TEXTREADER_FLAT_EMPTY)
+        node->extra = NODE_IS_EMPTY;
+
+    for (i = 0; i < ev->nbNs; i++) {
+        xmlNsPtr ns = &elem->nsTab[i];
+
+        memset(ns, 0, sizeof(*ns));
+        ns->type = XML_NAMESPACE_DECL;
+        ns->href = attrs[i].URI;
+        ns->prefix = attrs[i].name;
+        ns->context = doc;
+        if (i > 0)
+            elem->nsTab[i - 1].next = ns;
+    }
+    if (ev->nbNs > 0)
+        node->nsDef = elem->nsTab;
+    nsNr = ev->nbNs;
+    if (ev->URI != NULL)
+        node->ns = xmlTextReaderFlatNs(elem, ev->nbNs, &nsNr, ev->prefix,
+                                       ev->URI);
+
+    offset = 0;
+    for (i = 0; i < ev->nbAttrs; i++) {
+        xmlTextReaderFlatAttr *attr = &attrs[ev->nbNs + i];
+        xmlAttrPtr prop = &elem->attrTab[i];
+        xmlNodePtr text = &elem->textTab[i];
+
+        memcpy(&elem->values[offset], &reader->flatQ->text[attr->value],
+               attr->valueLen + 1);
+
+        memset(text, 0, sizeof(*text));
+        text->type = XML_TEXT_NODE;
+        text->name = xmlStringText;
+        text->content = &elem->values[offset];
+        text->parent = (xmlNodePtr) prop;
+        text->doc = doc;
+        offset += attr->valueLen + 1;
+
+        memset(prop, 0, sizeof(*prop));
+        prop->type = XML_ATTRIBUTE_NODE;
+        prop->name = attr->name;
+        prop->children = text;
+        prop->last = text;
+        prop->parent = node;
+        prop->doc = doc;
+        if (attr->URI != NULL)
+            prop->ns = xmlTextReaderFlatNs(elem, ev->nbNs, &nsNr,
+                                           attr->prefix, attr->URI);
+        if (i > 0) {
+            prop->prev = &elem->attrTab[i - 1];
+            elem->attrTab[i - 1].next = prop;
+        }
+    }
+    if (ev->nbAttrs > 0)
+        node->properties = elem->attrTab;
+
+    reader->node = node;
+    return(0);
+
+mem_error:
+    xmlTextReaderErrMemory(reader);
+    return(-1);
+}
+
+/**
+ * Expose text, a comment, a PI or an entity reference.
+ *
+ * @param reader  the xmlTextReader used
+ * @param ev  the event
+ */
+static void
+xmlTextReaderFlatLeaf(xmlTextReaderPtr reader, xmlTextReaderFlatEvent *ev) {
+    xmlNodePtr node = &reader->flatLeaf;
+
+    memset(node, 0, sizeof(*node));
+    node->type = ev->type;
+    switch (ev->type) {
+        case XML_TEXT_NODE:
+            node->name = xmlStringText;
+            break;
+        case XML_COMMENT_NODE:
+            node->name = xmlStringComment;
+            break;
+        default:
+            node->name = ev->name;
+            break;
+    }
+    if (ev->content >= 0)
+        node->content = &reader->flatQ->text[ev->content];
+    node->doc = xmlTextReaderFlatDoc(reader);
+    if (ev->depth > 0)
+        node->parent = &reader->flatElemTab[ev->depth - 1]->node;
+    else
+        node->parent = (xmlNodePtr) node->doc;
+
+    reader->node = node;
+}
+
+/**
+ * Build a start tag for xmlTextReaderExpand in flat mode.
+ *
+ * @param reader  the xmlTextReader used
+ * @param ev  the event
+ * @param parent  the parent used to look up namespaces
+ * @returns the new element or NULL if a memory allocation failed
+ */
+static xmlNodePtr
+xmlTextReaderFlatBuildElement(xmlTextReaderPtr reader,
+                              xmlTextReaderFlatEvent *ev, xmlNodePtr parent) {
+    xmlTextReaderFlatAttr *attrs = &reader->flatQ->attrTab[ev->attrs];
+    xmlNodePtr node;
+    xmlNsPtr ns;
+    int i;
+
+    node = xmlNewDocNode(xmlTextReaderFlatDoc(reader), NULL, ev->name, NULL);
+    if (node == NULL)
+        return(NULL);
+    node->parent = parent;
+    if (ev->flags & XML_TEXTREADER_FLAT_EMPTY)
+        node->extra = NODE_IS_EMPTY;
+
+    for (i = 0; i < ev->nbNs; i++) {
+        if (xmlNewNs(node, attrs[i].URI, attrs[i].name) == NULL)
+            goto error;
+    }
+    if (ev->URI != NULL) {
+        if (xmlSearchNsSafe(node, ev->prefix, &node->ns) < 0)
+            goto error;
+    }
+    for (i = ev->nbNs; i < ev->nbNs + ev->nbAttrs; i++) {
+        ns = NULL;
+        if ((attrs[i].URI != NULL) &&
+            (xmlSearchNsSafe(node, attrs[i].prefix, &ns) < 0))
+            goto error;
+        if (xmlNewNsProp(node, ns, attrs[i].name,
+                         &reader->flatQ->text[attrs[i].value]) == NULL)
+            goto error;
+    }
+
+    return(node);
+
+error:
+    xmlFreeNode(node);
+    return(NULL);
+}
+
+/**
+ * Build the subtree of the current start tag from queued events.
+ *
+ * @param reader  the xmlTextReader used
+ * @param last  the index of the last event of the subtree
+ * @returns the subtree or NULL if a memory allocation failed
+ */
+static xmlNodePtr
+xmlTextReaderFlatBuild(xmlTextReaderPtr reader, int last) {
+    xmlDocPtr doc = xmlTextReaderFlatDoc(reader);
+    xmlNodePtr root = NULL, parent = NULL, node;
+    int i;
+
+    for (i = reader->flatCur; i <= last; i++) {
+        xmlTextReaderFlatEvent *ev = &reader->flatQ->tab[i];
+        const xmlChar *content = NULL;
+
+        if (ev->flags & XML_TEXTREADER_FLAT_END) {
+            if (parent != NULL)
+                parent = (parent == root) ? NULL : parent->parent;
+            continue;
+        }
+
+        if (ev->content >= 0)
+            content = &reader->flatQ->text[ev->content];
+        switch (ev->type) {
+            case XML_ELEMENT_NODE:
+                node = xmlTextReaderFlatBuildElement(reader, ev,
+                        (root == NULL) ? reader->node->parent : parent);
+                break;
+            case XML_TEXT_NODE:
+                node = xmlNewDocTextLen(doc, content, ev->contentLen);
+                break;
+            case XML_CDATA_SECTION_NODE:
+                node = xmlNewCDataBlock(doc, content, ev->contentLen);
+                break;
+            case XML_COMMENT_NODE:
+                node = xmlNewDocComment(doc, content);
+                break;
+            case XML_PI_NODE:
+                node = xmlNewDocPI(doc, ev->name, content);
+                break;
+            case XML_ENTITY_REF_NODE:
+                node = xmlNewReference(doc, ev->name);
+                break;
+            default:
+                continue;
+        }
+        if (node == NULL) {
+            if (root != NULL)
+                xmlFreeNode(root);
+            xmlTextReaderErrMemory(reader);
+            return(NULL);
+        }
+
+        if (root == NULL) {
+            root = node;
+            root->parent = reader->node->parent;
+        } else if (parent != NULL) {
+            node->parent = parent;
+            if (parent->last == NULL) {
+                parent->children = node;
+            } else {
+                parent->last->next = node;
+                node->prev = parent->last;
+            }
+            parent->last = node;
+        }
+        if ((ev->type == XML_ELEMENT_NODE) &&
+            ((ev->flags & XML_TEXTREADER_FLAT_EMPTY) == 0))
+            parent = node;
+    }
+
+    return(root);
+}
+
+/**
+ * Build the subtree of the current node in flat mode, reading ahead
+ * as needed. Queued events are kept, so the reader still visits the
+ * nodes of the subtree.
+ *
+ * @param reader  the xmlTextReader used
+ * @returns the current node or NULL in case of error
+ */
+static xmlNodePtr
+xmlTextReaderFlatExpand(xmlTextReaderPtr reader) {
+    xmlTextReaderFlatEvent *ev;
+    xmlNodePtr tree;
+    int last;
+
+    if (reader->flatTree != NULL)
+        return(reader->flatTree);
+    if ((reader->flatCur < 0) || (reader->flatCur >= reader->flatQ->nr))
+        return(reader->node);
+    ev = &reader->flatQ->tab[reader->flatCur];
+    if ((ev->type != XML_ELEMENT_NODE) ||
+        (ev->flags & XML_TEXTREADER_FLAT_END))
+        return(reader->node);
+
+    last = reader->flatCur;
+    if ((ev->flags & XML_TEXTREADER_FLAT_EMPTY) == 0) {
+        while (1) {
+            last++;
+            while (last >= reader->flatQ->nr) {
+                int ret = xmlTextReaderFlatMore(reader);
+
+                if (ret == 0) {
+                    last = reader->flatQ->nr - 1;
+                    goto build;
+                }
+                if (ret < 0) {
+                    reader->mode = XML_TEXTREADER_MODE_ERROR;
+                    reader->state = XML_TEXTREADER_ERROR;
+                    return(NULL);
+                }
+            }
+            ev = &reader->flatQ->tab[last];
+            if ((ev->flags & XML_TEXTREADER_FLAT_END) &&
+                (ev->depth == reader->depth))
+                break;
+        }
+    }
+
+build:
+    tree = xmlTextReaderFlatBuild(reader, last);
+    if (tree == NULL)
+        return(NULL);
+    reader->flatTree = tree;
+    reader->node = tree;
+
+    return(tree);
+}
+
+/**
+ * Move to the next queued event in flat mode, parsing more input
+ * as needed.
+ *
+ * @param reader  the xmlTextReader used
+ * @returns 1 if the node was read successfully, 0 if there is no more
+ *          nodes to read, or -1 in case of error
+ */
+static int
+xmlTextReaderFlatRead(xmlTextReaderPtr reader) {
+    xmlTextReaderFlatEvent *ev;
+    int cur;
+
+    xmlTextReaderFlatFreeTree(reader);
+
+    if (reader->mode == XML_TEXTREADER_MODE_INITIAL) {
+        if (!xmlTextReaderTreeOptional(reader, NULL)) {
+            reader->mode = XML_TEXTREADER_MODE_ERROR;
+            reader->state = XML_TEXTREADER_ERROR;
+            return(-1);
+        }
+        reader->mode = XML_TEXTREADER_MODE_INTERACTIVE;
+        reader->ctxt->parseMode = XML_PARSE_READER;
+        reader->flatCur = -1;
+#ifdef XML_TEXTREADER_PIPELINE
+        /* Fall back to parsing in this thread */
+        if (reader->pipelined)
+            xmlTextReaderPipeStart(reader);
+#endif
+    }
+
+    cur = reader->flatCur + 1;
+    if (cur >= reader->flatQ->nr) {
+        /* Everything was read, recycle the queue */
+        reader->flatQ->nr = 0;
+        reader->flatQ->attrNr = 0;
+        reader->flatQ->textNr = 0;
+        reader->flatCur = -1;
+        cur = 0;
+    }
+
+    /*
+     * Make sure that the next event was parsed and that text is
+     * complete.
+     */
+    while ((cur >= reader->flatQ->nr) ||
+           ((reader->flatQ->tab[cur].type == XML_TEXT_NODE) &&
+            (cur + 1 >= reader->flatQ->nr))) {
+        int ret = xmlTextReaderFlatMore(reader);
+
+        if (ret == 0)
+            break;
+        if (ret < 0) {
+            reader->mode = XML_TEXTREADER_MODE_ERROR;
+            reader->state = XML_TEXTREADER_ERROR;
+            return(-1);
+        }
+    }
+
+    if (cur >= reader->flatQ->nr) {
+        reader->node = NULL;
+        reader->depth = -1;
+        reader->state = XML_TEXTREADER_DONE;
+        return(0);
+    }
+
+    reader->flatCur = cur;
+    ev = &reader->flatQ->tab[cur];
+    reader->depth = ev->depth;
+    if (ev->flags & XML_TEXTREADER_FLAT_END) {
+        reader->node = &reader->flatElemTab[ev->depth]->node;
+        reader->state = XML_TEXTREADER_BACKTRACK;
+        return(1);
+    }
+
+    reader->state = XML_TEXTREADER_ELEMENT;
+    switch (ev->type) {
+        case XML_ELEMENT_NODE:
+            if (xmlTextReaderFlatElement(reader, ev) < 0)
+                return(-1);
+            break;
+        case XML_DTD_NODE:
+            reader->node = (xmlNodePtr) reader->ctxt->myDoc->intSubset;
+            break;
+        default:
+            xmlTextReaderFlatLeaf(reader, ev);
+            break;
+    }
 
-    return(0);
+    return(1);
 }
 
 /**
- * Handle the validation when an entity reference is encountered and
- * entity substitution is not activated. As a result the parser interface
- * must walk through the entity and do the validation calls
+ * Skip the subtree of the current node in flat mode.
  *
  * @param reader  the xmlTextReader used
+ * @returns 1 if the node was read successfully, 0 if there is no more
+ *          nodes to read, or -1 in case of error
  */
 static int
-xmlTextReaderValidateEntity(xmlTextReaderPtr reader) {
-    xmlNodePtr oldnode = reader->node;
-    xmlNodePtr node = reader->node;
+xmlTextReaderFlatNext(xmlTextReaderPtr reader) {
+    xmlTextReaderFlatEvent *ev;
+    int depth, ret;
 
-    do {
-	if (node->type == XML_ENTITY_REF_NODE) {
-	    if ((node->children != NULL) &&
-		(node->children->type == XML_ENTITY_DECL) &&
-		(node->children->children != NULL)) {
-		if (xmlTextReaderEntPush(reader, node) < 0) {
-                    if (node == oldnode)
-                        break;
-                    goto skip_children;
-                }
-		node = node->children->children;
-		continue;
-	    } else {
-		/*
-		 * The error has probably been raised already.
-		 */
-		if (node == oldnode)
-		    break;
-                goto skip_children;
-	    }
-#ifdef LIBXML_REGEXP_ENABLED
-	} else if (node->type == XML_ELEMENT_NODE) {
-	    reader->node = node;
-	    if (xmlTextReaderValidatePush(reader) < 0)
-                return(-1);
-	} else if ((node->type == XML_TEXT_NODE) ||
-		   (node->type == XML_CDATA_SECTION_NODE)) {
-            xmlTextReaderValidateCData(reader, node->content,
-	                               xmlStrlen(node->content));
-#endif
-	}
+    if ((reader->node == NULL) || (reader->flatCur < 0) ||
+        (reader->flatCur >= reader->flatQ->nr))
+        return(xmlTextReaderRead(reader));
+    ev = &reader->flatQ->tab[reader->flatCur];
+    if ((ev->type != XML_ELEMENT_NODE) ||
+        (ev->flags & (XML_TEXTREADER_FLAT_END | XML_TEXTREADER_FLAT_EMPTY)))
+        return(xmlTextReaderRead(reader));
 
-	/*
-	 * go to next node
-	 */
-	if (node->children != NULL) {
-	    node = node->children;
-	    continue;
-	} else if (node->type == XML_ELEMENT_NODE) {
-	    if (xmlTextReaderValidatePop(reader) < 0)
-                return(-1);
-	}
-skip_children:
-	if (node->next != NULL) {
-	    node = node->next;
-	    continue;
-	}
-	do {
-	    node = node->parent;
-	    if (node->type == XML_ELEMENT_NODE) {
-	        xmlNodePtr tmp;
-		if (reader->entNr == 0) {
-		    while ((tmp = node->last) != NULL) {
-			if ((tmp->extra & NODE_IS_PRESERVED) == 0) {
-			    xmlUnlinkNode(tmp);
-			    xmlTextReaderFreeNode(reader, tmp);
-			} else
-			    break;
-		    }
-		}
-		reader->node = node;
-		if (xmlTextReaderValidatePop(reader) < 0)
-                    return(-1);
-	    }
-	    if ((node->type == XML_ENTITY_DECL) &&
-		(reader->ent != NULL) && (reader->ent->children == node)) {
-		node = xmlTextReaderEntPop(reader);
-	    }
-	    if (node == oldnode)
-		break;
-	    if (node->next != NULL) {
-		node = node->next;
-		break;
-	    }
-	} while ((node != NULL) && (node != oldnode));
-    } while ((node != NULL) && (node != oldnode));
-    reader->node = oldnode;
+    depth = reader->depth;
+    /* The parser thread is ahead anyway */
+    if ((reader->pipe == NULL) && (reader->flatDepth > depth))
+        xmlTextReaderSkipStart(reader, reader->flatDepth - depth);
+    do {
+        ret = xmlTextReaderRead(reader);
+        if (ret != 1)
+            break;
+    } while ((reader->state != XML_TEXTREADER_BACKTRACK) ||
+             (reader->depth != depth));
+    xmlTextReaderSkipEnd(reader);
+    if (ret != 1)
+        return(ret);
 
-    return(0);
+    return(xmlTextReaderRead(reader));
 }
-#endif /* LIBXML_REGEXP_ENABLED */
-
 
 /**
  * Get the successor of a node if available.
@@ -1168,6 +3102,8 @@ xmlTextReaderDoExpand(xmlTextReaderPtr reader) {
 
     if ((reader == NULL) || (reader->node == NULL) || (reader->ctxt == NULL))
         return(-1);
+    if (reader->flat)
+        return((xmlTextReaderFlatExpand(reader) != NULL) ? 1 : -1);
     do {
 	if (PARSER_STOPPED(reader->ctxt))
             return(1);
@@ -1212,6 +3148,8 @@ xmlTextReaderRead(xmlTextReader *reader) {
         return(xmlTextReaderReadTree(reader));
     if (reader->ctxt == NULL)
 	return(-1);
+    if (reader->flat)
+        return(xmlTextReaderFlatRead(reader));
 
     if (reader->mode == XML_TEXTREADER_MODE_INITIAL) {
 	reader->mode = XML_TEXTREADER_MODE_INTERACTIVE;
@@ -1526,12 +3464,21 @@ node_found:
     if ((reader->patternNr > 0) && (reader->state != XML_TEXTREADER_END) &&
         (reader->state != XML_TEXTREADER_BACKTRACK)) {
         int i;
-	for (i = 0;i < reader->patternNr;i++) {
-	     if (xmlPatternMatch(reader->patternTab[i], reader->node) == 1) {
-	         xmlTextReaderPreserve(reader);
-		 break;
-             }
-	}
+
+        /* Elements were already matched when they were parsed */
+        if (reader->patternStream != NULL) {
+            if ((reader->node->type == XML_ELEMENT_NODE) &&
+                (reader->node->extra & NODE_IS_MATCHED))
+                xmlTextReaderPreserve(reader);
+        } else {
+            for (i = 0;i < reader->patternNr;i++) {
+                if (xmlPatternMatch(reader->patternTab[i],
+                                    reader->node) == 1) {
+                    xmlTextReaderPreserve(reader);
+                    break;
+                }
+            }
+        }
     }
 #endif /* LIBXML_PATTERN_ENABLED */
 #ifdef LIBXML_SCHEMAS_ENABLED
@@ -1592,12 +3539,15 @@ xmlTextReaderExpand(xmlTextReader *reader) {
 int
 xmlTextReaderNext(xmlTextReader *reader) {
     int ret;
+    int skipping = 0;
     xmlNodePtr cur;
 
     if (reader == NULL)
 	return(-1);
     if (reader->doc != NULL)
         return(xmlTextReaderNextTree(reader));
+    if (reader->flat)
+        return(xmlTextReaderFlatNext(reader));
     cur = reader->node;
     if ((cur == NULL) || (cur->type != XML_ELEMENT_NODE))
         return(xmlTextReaderRead(reader));
@@ -1605,11 +3555,36 @@ xmlTextReaderNext(xmlTextReader *reader) {
         return(xmlTextReaderRead(reader));
     if (cur->extra & NODE_IS_EMPTY)
         return(xmlTextReaderRead(reader));
+
+    /*
+     * If the end tag wasn't parsed yet, drop the rest of the subtree
+     * instead of building it. A subtree which is already dropped
+     * because of pruning is left alone.
+     */
+    if ((reader->preserves == 0) && (!reader->skipping) &&
+        (xmlTextReaderTreeOptional(reader, cur))) {
+        xmlNodePtr node;
+        int open = 0;
+
+        for (node = reader->ctxt->node; node != NULL; node = node->parent) {
+            open++;
+            if (node == cur) {
+                xmlTextReaderSkipStart(reader, open);
+                skipping = reader->skipping;
+                break;
+            }
+        }
+    }
+
     do {
         ret = xmlTextReaderRead(reader);
 	if (ret != 1)
-	    return(ret);
+	    break;
     } while (reader->node != cur);
+    if (skipping)
+        xmlTextReaderSkipEnd(reader);
+    if (ret != 1)
+        return(ret);
     return(xmlTextReaderRead(reader));
 }
 
@@ -1748,8 +3723,11 @@ xmlTextReaderReadString(xmlTextReader *reader)
         case XML_CDATA_SECTION_NODE:
             break;
         case XML_ELEMENT_NODE:
-            if ((xmlTextReaderDoExpand(reader) == -1) ||
-                (node->children == NULL))
+            if (xmlTextReaderDoExpand(reader) == -1)
+                return(NULL);
+            /* In flat mode, the subtree replaces the current node */
+            node = reader->node;
+            if (node->children == NULL)
                 return(NULL);
             break;
         default:
@@ -2138,9 +4116,9 @@ xmlFreeTextReader(xmlTextReader *reader) {
     }
 #endif
 #ifdef LIBXML_SCHEMAS_ENABLED
-    if (reader->xsdPlug != NULL) {
-	xmlSchemaSAXUnplug(reader->xsdPlug);
-	reader->xsdPlug = NULL;
+    if (reader->xsdAttached) {
+	xmlSchemaValidateDetach(reader->xsdValidCtxt);
+	reader->xsdAttached = 0;
     }
     if (reader->xsdValidCtxt != NULL) {
 	if (! reader->xsdPreserveCtxt)
@@ -2165,9 +4143,11 @@ xmlFreeTextReader(xmlTextReader *reader) {
 	}
 	xmlFree(reader->patternTab);
     }
+    xmlTextReaderPatternFallback(reader);
 #endif
     if (reader->mode != XML_TEXTREADER_MODE_CLOSED)
         xmlTextReaderClose(reader);
+    xmlTextReaderFlatFree(reader);
     if (reader->ctxt != NULL) {
         if (reader->dict == reader->ctxt->dict)
 	    reader->dict = NULL;
@@ -2178,6 +4158,9 @@ xmlFreeTextReader(xmlTextReader *reader) {
 	xmlFree(reader->sax);
     if (reader->buffer != NULL)
         xmlBufFree(reader->buffer);
+    xmlFree(reader->attrViewTab);
+    if (reader->attrViewBuf != NULL)
+        xmlBufFree(reader->attrViewBuf);
     if (reader->entTab != NULL)
 	xmlFree(reader->entTab);
     if (reader->dict != NULL)
@@ -2202,6 +4185,8 @@ int
 xmlTextReaderClose(xmlTextReader *reader) {
     if (reader == NULL)
 	return(-1);
+    xmlTextReaderFlatFreeTree(reader);
+    xmlTextReaderPipeStop(reader);
     reader->node = NULL;
     reader->curnode = NULL;
     reader->mode = XML_TEXTREADER_MODE_CLOSED;
@@ -2442,6 +4427,8 @@ xmlTextReaderGetRemainder(xmlTextReader *reader) {
     if (reader->node == NULL)
 	return(NULL);
 
+    xmlTextReaderFlatFreeTree(reader);
+    xmlTextReaderPipeStop(reader);
     reader->node = NULL;
     reader->curnode = NULL;
     reader->mode = XML_TEXTREADER_MODE_EOF;
@@ -2916,6 +4903,148 @@ xmlTextReaderAttributeCount(xmlTextReader *reader) {
     return(ret);
 }
 
+/**
+ * Get all attributes of the current element node, including namespace
+ * declarations, in the order of #xmlTextReaderMoveToNextAttribute.
+ * This avoids moving to each attribute in turn. Values with entity
+ * references are concatenated like #xmlTextReaderConstValue does.
+ *
+ * The array and the strings are owned by the reader and are valid
+ * until the next call to #xmlTextReaderGetAttributes or until the
+ * reader moves to another node.
+ *
+ * @since 2.16.0
+ *
+ * @param reader  the xmlTextReader used
+ * @param attrs  pointer to the resulting array of attributes
+ * @returns the number of attributes or -1 in case of error
+ */
+int
+xmlTextReaderGetAttributes(xmlTextReader *reader,
+                           const xmlTextReaderAttr **attrs) {
+    xmlTextReaderAttr *view;
+    xmlNodePtr node;
+    xmlAttrPtr attr;
+    xmlNsPtr ns;
+    int nb = 0, nbBuf = 0, i;
+
+    if ((reader == NULL) || (attrs == NULL))
+        return(-1);
+    *attrs = NULL;
+    node = reader->node;
+    if ((node == NULL) || (node->type != XML_ELEMENT_NODE) ||
+        (reader->state == XML_TEXTREADER_END) ||
+        (reader->state == XML_TEXTREADER_BACKTRACK))
+        return(0);
+
+    for (ns = node->nsDef; ns != NULL; ns = ns->next)
+        nb++;
+    for (attr = node->properties; attr != NULL; attr = attr->next)
+        nb++;
+    if (nb == 0)
+        return(0);
+
+    if (nb > reader->attrViewMax) {
+        xmlTextReaderAttr *tmp;
+        int newSize = reader->attrViewMax;
+
+        do {
+            newSize = xmlGrowCapacity(newSize, sizeof(tmp[0]), 8,
+                                      XML_MAX_ITEMS);
+            if (newSize < 0) {
+                xmlTextReaderErrMemory(reader);
+                return(-1);
+            }
+        } while (newSize < nb);
+        tmp = xmlRealloc(reader->attrViewTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlTextReaderErrMemory(reader);
+            return(-1);
+        }
+        reader->attrViewTab = tmp;
+        reader->attrViewMax = newSize;
+    }
+
+    view = reader->attrViewTab;
+    for (ns = node->nsDef; ns != NULL; ns = ns->next, view++) {
+        if (ns->prefix == NULL) {
+            view->localname = BAD_CAST "xmlns";
+            view->prefix = NULL;
+        } else {
+            view->localname = ns->prefix;
+            view->prefix = BAD_CAST "xmlns";
+        }
+        view->URI = BAD_CAST "http://www.w3.org/2000/xmlns/";
+        view->value = (ns->href != NULL) ? ns->href : BAD_CAST "";
+        view->len = xmlStrlen(view->value);
+    }
+
+    for (attr = node->properties; attr != NULL; attr = attr->next, view++) {
+        view->localname = attr->name;
+        if (attr->ns != NULL) {
+            view->prefix = attr->ns->prefix;
+            view->URI = attr->ns->href;
+        } else {
+            view->prefix = NULL;
+            view->URI = NULL;
+        }
+
+        if ((attr->children != NULL) &&
+            (attr->children->type == XML_TEXT_NODE) &&
+            (attr->children->next == NULL) &&
+            (attr->children->content != NULL)) {
+            view->value = attr->children->content;
+            view->len = xmlStrlen(view->value);
+        } else if (attr->children == NULL) {
+            view->value = BAD_CAST "";
+            view->len = 0;
+        } else {
+            size_t start;
+
+            /*
+             * Values are separated by a 0 byte. The buffer may still
+             * move, pointers are set below.
+             */
+            if (reader->attrViewBuf == NULL) {
+                reader->attrViewBuf = xmlBufCreate(50);
+                if (reader->attrViewBuf == NULL) {
+                    xmlTextReaderErrMemory(reader);
+                    return(-1);
+                }
+            } else if (nbBuf == 0) {
+                xmlBufEmpty(reader->attrViewBuf);
+            }
+            start = xmlBufUse(reader->attrViewBuf);
+            xmlBufGetNodeContent(reader->attrViewBuf, (xmlNodePtr) attr);
+            view->value = NULL;
+            view->len = (int) (xmlBufUse(reader->attrViewBuf) - start);
+            if ((xmlBufAdd(reader->attrViewBuf, BAD_CAST "", 1) < 0) ||
+                (xmlBufContent(reader->attrViewBuf) == NULL)) {
+                xmlTextReaderErrMemory(reader);
+                xmlBufFree(reader->attrViewBuf);
+                reader->attrViewBuf = NULL;
+                return(-1);
+            }
+            nbBuf++;
+        }
+    }
+
+    if (nbBuf > 0) {
+        const xmlChar *cur = xmlBufContent(reader->attrViewBuf);
+
+        for (i = 0; i < nb; i++) {
+            view = &reader->attrViewTab[i];
+            if (view->value == NULL) {
+                view->value = cur;
+                cur += view->len + 1;
+            }
+        }
+    }
+
+    *attrs = reader->attrViewTab;
+    return(nb);
+}
+
 /**
  * Get the node type of the current node
  * Reference:
@@ -3766,6 +5895,7 @@ xmlTextReaderGetParserLineNumber(xmlTextReader *reader)
         (reader->ctxt->input == NULL)) {
         return (0);
     }
+    xmlParserInputSyncLines(reader->ctxt->input);
     return (reader->ctxt->input->line);
 }
 
@@ -3782,6 +5912,7 @@ xmlTextReaderGetParserColumnNumber(xmlTextReader *reader)
         (reader->ctxt->input == NULL)) {
         return (0);
     }
+    xmlParserInputSyncLines(reader->ctxt->input);
     return (reader->ctxt->input->col);
 }
 
@@ -3808,6 +5939,8 @@ xmlTextReaderCurrentNode(xmlTextReader *reader) {
  * The caller must also use #xmlTextReaderCurrentDoc to
  * keep an handle on the resulting document once parsing has finished
  *
+ * Not available in flat mode.
+ *
  * @param reader  the xmlTextReader used
  * @returns the xmlNode or NULL in case of error.
  */
@@ -3815,7 +5948,7 @@ xmlNode *
 xmlTextReaderPreserve(xmlTextReader *reader) {
     xmlNodePtr cur, parent;
 
-    if (reader == NULL)
+    if ((reader == NULL) || (reader->flat))
 	return(NULL);
 
     cur = reader->node;
@@ -3843,6 +5976,14 @@ xmlTextReaderPreserve(xmlTextReader *reader) {
  * pattern. The caller must also use #xmlTextReaderCurrentDoc to
  * keep an handle on the resulting document once parsing has finished
  *
+ * If all patterns are added before the first read and select
+ * elements only, they are matched by a single automaton while
+ * parsing. Then #xmlTextReaderNext can skip subtrees which can't
+ * contain matches without building them, see also
+ * #xmlTextReaderSetPreservePrune.
+ *
+ * Not available in flat mode.
+ *
  * @param reader  the xmlTextReader used
  * @param pattern  an XPath subset pattern
  * @param namespaces  the prefix definitions, array of [URI, prefix] or NULL
@@ -3854,7 +5995,7 @@ xmlTextReaderPreservePattern(xmlTextReader *reader, const xmlChar *pattern,
 {
     xmlPatternPtr comp;
 
-    if ((reader == NULL) || (pattern == NULL))
+    if ((reader == NULL) || (pattern == NULL) || (reader->flat))
 	return(-1);
 
     comp = xmlPatterncompile(pattern, reader->dict, 0, namespaces);
@@ -3880,6 +6021,22 @@ xmlTextReaderPreservePattern(xmlTextReader *reader, const xmlChar *pattern,
         reader->patternMax = newSize;
     }
     reader->patternTab[reader->patternNr] = comp;
+
+    /* Included nodes aren't seen while parsing */
+    if ((reader->patternNr == 0) &&
+        (reader->mode == XML_TEXTREADER_MODE_INITIAL)
+#ifdef LIBXML_XINCLUDE_ENABLED
+        && (reader->xinclude == 0)
+#endif
+        ) {
+        reader->patternSet = xmlNewPatternSet();
+        reader->patternStream = xmlPatternSetGetStreamCtxt(reader->patternSet);
+    }
+    if ((reader->mode != XML_TEXTREADER_MODE_INITIAL) ||
+        (reader->patternStream == NULL) ||
+        (xmlPatternSetAdd(reader->patternSet, comp, reader->patternNr) < 0))
+        xmlTextReaderPatternFallback(reader);
+
     return(reader->patternNr++);
 }
 #endif
@@ -4032,9 +6189,9 @@ xmlTextReaderSetSchema(xmlTextReader *reader, xmlSchema *schema) {
     if (reader == NULL)
         return(-1);
     if (schema == NULL) {
-	if (reader->xsdPlug != NULL) {
-	    xmlSchemaSAXUnplug(reader->xsdPlug);
-	    reader->xsdPlug = NULL;
+	if (reader->xsdAttached) {
+	    xmlSchemaValidateDetach(reader->xsdValidCtxt);
+	    reader->xsdAttached = 0;
 	}
         if (reader->xsdValidCtxt != NULL) {
 	    if (! reader->xsdPreserveCtxt)
@@ -4050,9 +6207,9 @@ xmlTextReaderSetSchema(xmlTextReader *reader, xmlSchema *schema) {
     }
     if (reader->mode != XML_TEXTREADER_MODE_INITIAL)
 	return(-1);
-    if (reader->xsdPlug != NULL) {
-	xmlSchemaSAXUnplug(reader->xsdPlug);
-	reader->xsdPlug = NULL;
+    if (reader->xsdAttached) {
+	xmlSchemaValidateDetach(reader->xsdValidCtxt);
+	reader->xsdAttached = 0;
     }
     if (reader->xsdValidCtxt != NULL) {
 	if (! reader->xsdPreserveCtxt)
@@ -4070,16 +6227,14 @@ xmlTextReaderSetSchema(xmlTextReader *reader, xmlSchema *schema) {
 	reader->xsdSchemas = NULL;
         return(-1);
     }
-    reader->xsdPlug = xmlSchemaSAXPlug(reader->xsdValidCtxt,
-                                       &(reader->ctxt->sax),
-				       &(reader->ctxt->userData));
-    if (reader->xsdPlug == NULL) {
+    if (xmlSchemaValidateAttach(reader->xsdValidCtxt, reader->ctxt) < 0) {
 	xmlSchemaFree(reader->xsdSchemas);
 	reader->xsdSchemas = NULL;
 	xmlSchemaFreeValidCtxt(reader->xsdValidCtxt);
 	reader->xsdValidCtxt = NULL;
 	return(-1);
     }
+    reader->xsdAttached = 1;
     xmlSchemaValidateSetLocator(reader->xsdValidCtxt,
                                 xmlTextReaderLocator,
 				(void *) reader);
@@ -4212,9 +6367,9 @@ xmlTextReaderSchemaValidateInternal(xmlTextReaderPtr reader,
 	return(-1);
 
     /* Cleanup previous validation stuff. */
-    if (reader->xsdPlug != NULL) {
-	xmlSchemaSAXUnplug(reader->xsdPlug);
-	reader->xsdPlug = NULL;
+    if (reader->xsdAttached) {
+	xmlSchemaValidateDetach(reader->xsdValidCtxt);
+	reader->xsdAttached = 0;
     }
     if (reader->xsdValidCtxt != NULL) {
 	if (! reader->xsdPreserveCtxt)
@@ -4249,10 +6404,7 @@ xmlTextReaderSchemaValidateInternal(xmlTextReaderPtr reader,
 	    reader->xsdSchemas = NULL;
 	    return(-1);
 	}
-	reader->xsdPlug = xmlSchemaSAXPlug(reader->xsdValidCtxt,
-	    &(reader->ctxt->sax),
-	    &(reader->ctxt->userData));
-	if (reader->xsdPlug == NULL) {
+	if (xmlSchemaValidateAttach(reader->xsdValidCtxt, reader->ctxt) < 0) {
 	    xmlSchemaFree(reader->xsdSchemas);
 	    reader->xsdSchemas = NULL;
 	    xmlSchemaFreeValidCtxt(reader->xsdValidCtxt);
@@ -4263,15 +6415,13 @@ xmlTextReaderSchemaValidateInternal(xmlTextReaderPtr reader,
 	/* Use the given validation context. */
 	reader->xsdValidCtxt = ctxt;
 	reader->xsdPreserveCtxt = 1;
-	reader->xsdPlug = xmlSchemaSAXPlug(reader->xsdValidCtxt,
-	    &(reader->ctxt->sax),
-	    &(reader->ctxt->userData));
-	if (reader->xsdPlug == NULL) {
+	if (xmlSchemaValidateAttach(reader->xsdValidCtxt, reader->ctxt) < 0) {
 	    reader->xsdValidCtxt = NULL;
 	    reader->xsdPreserveCtxt = 0;
 	    return(-1);
 	}
     }
+    reader->xsdAttached = 1;
     xmlSchemaValidateSetLocator(reader->xsdValidCtxt,
                                 xmlTextReaderLocator,
 				(void *) reader);
@@ -4467,6 +6617,7 @@ xmlTextReaderLocatorLineNumber(xmlTextReaderLocatorPtr locator) {
 	if ((input->filename == NULL) && (ctx->inputNr > 1))
 	    input = ctx->inputTab[ctx->inputNr - 2];
 	if (input != NULL) {
+            xmlParserInputSyncLines(input);
 	    ret = input->line;
 	}
 	else {
@@ -4697,6 +6848,9 @@ xmlTextReaderIsValid(xmlTextReader *reader)
 /**
  * Setup an XML reader with new options
  *
+ * If XML Schema validation was enabled, the new document is validated
+ * against the same schema. The validation context is reset and reused.
+ *
  * @param reader  an XML reader
  * @param input  xmlParserInputBuffer used to feed the reader, will
  *         be destroyed with it.
@@ -4710,6 +6864,8 @@ xmlTextReaderSetup(xmlTextReader *reader,
                    xmlParserInputBuffer *input, const char *URL,
                    const char *encoding, int options)
 {
+    int i;
+
     if (reader == NULL) {
         if (input != NULL)
 	    xmlFreeParserInputBuffer(input);
@@ -4721,6 +6877,31 @@ xmlTextReaderSetup(xmlTextReader *reader,
      * since usr applications should never modify the tree
      */
     options |= XML_PARSE_COMPACT;
+    /*
+     * the reader frees and recycles nodes itself which doesn't work
+     * with arena allocation
+     */
+    options &= ~XML_PARSE_ARENA;
+
+    /* The expanded tree may use the document of the parser thread */
+    xmlTextReaderFlatFreeTree(reader);
+    xmlTextReaderPipeStop(reader);
+    if (reader->ctxt != NULL)
+        xmlTextReaderSkipEnd(reader);
+    if ((reader->flat) && (reader->ctxt != NULL))
+        xmlTextReaderFlatHandlers(reader, 0);
+    reader->flat = 0;
+    reader->pipelined = 0;
+    for (i = 0; i < 3; i++) {
+        reader->flatQueues[i].nr = 0;
+        reader->flatQueues[i].attrNr = 0;
+        reader->flatQueues[i].textNr = 0;
+    }
+    reader->flatQ = &reader->flatQueues[0];
+    reader->flatFill = reader->flatQ;
+    reader->flatCur = -1;
+    reader->flatDepth = 0;
+    reader->flatEmpty = 0;
 
     reader->doc = NULL;
     reader->entNr = 0;
@@ -4866,6 +7047,8 @@ xmlTextReaderSetup(xmlTextReader *reader,
             reader->patternTab[reader->patternNr] = NULL;
 	}
     }
+    xmlTextReaderPatternFallback(reader);
+    reader->patternPrune = 0;
 #endif
 
     if (options & XML_PARSE_DTDVALID)
@@ -4874,6 +7057,32 @@ xmlTextReaderSetup(xmlTextReader *reader,
     xmlCtxtUseOptions(reader->ctxt, options);
     if (encoding != NULL)
         xmlSwitchEncodingName(reader->ctxt, encoding);
+
+#ifdef LIBXML_SCHEMAS_ENABLED
+    /*
+     * Keep validating against the same schema. Attaching the validation
+     * context again resets it for the new document, the context and
+     * its stacks are reused.
+     */
+    if ((reader->xsdAttached) && (input != NULL)) {
+        xmlSchemaValidateDetach(reader->xsdValidCtxt);
+        reader->xsdAttached = 0;
+        if (xmlSchemaValidateAttach(reader->xsdValidCtxt, reader->ctxt) < 0) {
+            if (! reader->xsdPreserveCtxt)
+                xmlSchemaFreeValidCtxt(reader->xsdValidCtxt);
+            reader->xsdValidCtxt = NULL;
+            reader->xsdPreserveCtxt = 0;
+            if (reader->xsdSchemas != NULL) {
+                xmlSchemaFree(reader->xsdSchemas);
+                reader->xsdSchemas = NULL;
+            }
+            return(-1);
+        }
+        reader->xsdAttached = 1;
+        reader->xsdValidErrors = 0;
+        reader->validate = XML_TEXTREADER_VALIDATE_XSD;
+    }
+#endif
     if ((URL != NULL) && (reader->ctxt->input != NULL) &&
         (reader->ctxt->input->filename == NULL)) {
         reader->ctxt->input->filename = (char *)
@@ -4901,6 +7110,135 @@ xmlTextReaderSetMaxAmplification(xmlTextReader *reader, unsigned maxAmpl)
     xmlCtxtSetMaxAmplification(reader->ctxt, maxAmpl);
 }
 
+/**
+ * Enable or disable flat mode. In flat mode, the reader doesn't build
+ * a tree. The current node is exposed directly from parser events:
+ * names are shared with the dictionary, and text, comments and
+ * attribute values are only copied once. The node returned by
+ * #xmlTextReaderCurrentNode and the nodes it links to are only valid
+ * until the next call to #xmlTextReaderRead. #xmlTextReaderExpand
+ * builds the subtree of the current element.
+ *
+ * Flat mode must be set before the first call to #xmlTextReaderRead.
+ * It doesn't support validation, XInclude, SAX1 parsing and
+ * preserving nodes. XML_PARSE_NOBLANKS has no effect since blank
+ * detection needs a tree. Attribute values are exposed as a single
+ * text node with entity references expanded.
+ *
+ * @since 2.16.0
+ *
+ * @param reader  an XML reader
+ * @param flat  1 to enable flat mode, 0 to disable it
+ * @returns 0 on success or -1 if the reader already started reading
+ *         or uses a feature which requires a tree.
+ */
+int
+xmlTextReaderSetFlat(xmlTextReader *reader, int flat)
+{
+    if ((reader == NULL) || (reader->ctxt == NULL) ||
+        (reader->doc != NULL) ||
+        (reader->mode != XML_TEXTREADER_MODE_INITIAL))
+        return(-1);
+
+    flat = (flat != 0);
+    if ((flat) && (!xmlTextReaderTreeOptional(reader, NULL)))
+        return(-1);
+    if (flat != reader->flat) {
+        xmlTextReaderFlatHandlers(reader, flat);
+        reader->flat = flat;
+    }
+    if (!flat)
+        reader->pipelined = 0;
+    reader->flatQ = &reader->flatQueues[0];
+    reader->flatFill = reader->flatQ;
+    reader->flatCur = -1;
+
+    return(0);
+}
+
+/**
+ * Enable or disable pipelined mode. In pipelined mode, the document
+ * is parsed by a separate thread, so parsing overlaps with the
+ * processing of nodes. This switches the reader to flat mode, see
+ * #xmlTextReaderSetFlat. Events are handed to the reader in batches,
+ * subtrees are only built by #xmlTextReaderExpand.
+ *
+ * Error handlers are called from the parser thread. Functions which
+ * query the parser, like #xmlTextReaderGetParserLineNumber or
+ * #xmlTextReaderCurrentDoc, must not be used. Exposed nodes don't
+ * belong to the parsed document and strings returned by the reader
+ * are interned in a separate dictionary.
+ *
+ * Pipelined mode must be set before the first call to
+ * #xmlTextReaderRead. If the thread can't be started, the document is
+ * parsed by the calling thread.
+ *
+ * @since 2.16.0
+ *
+ * @param reader  an XML reader
+ * @param pipelined  1 to enable pipelined mode, 0 to disable it
+ * @returns 0 on success or -1 if the reader already started reading,
+ *         flat mode can't be used or threads aren't supported.
+ */
+int
+xmlTextReaderSetPipelined(xmlTextReader *reader, int pipelined)
+{
+    if ((reader == NULL) ||
+        (reader->mode != XML_TEXTREADER_MODE_INITIAL))
+        return(-1);
+
+    if (!pipelined) {
+        reader->pipelined = 0;
+        return(0);
+    }
+
+#ifdef XML_TEXTREADER_PIPELINE
+    if (xmlTextReaderSetFlat(reader, 1) < 0)
+        return(-1);
+    reader->pipelined = 1;
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+/**
+ * Enable or disable pruning with preserve patterns. When pruning,
+ * the content of elements which can't contain nodes matched by a
+ * pattern of #xmlTextReaderPreservePattern is dropped while parsing,
+ * so these elements are read as empty elements. Unpreserved nodes
+ * are freed once the reader moves past them, which caps memory
+ * usage for documents where most nodes are discarded.
+ *
+ * Pruning requires that the patterns are matched while parsing,
+ * otherwise nothing is dropped. It is disabled with validation and
+ * XInclude. Nodes preserved with #xmlTextReaderPreserve aren't
+ * protected from pruning.
+ *
+ * @since 2.16.0
+ *
+ * @param reader  an XML reader
+ * @param prune  1 to enable pruning, 0 to disable it
+ * @returns 0 on success or -1 if the reader already started reading
+ *         or preserve patterns aren't supported.
+ */
+int
+xmlTextReaderSetPreservePrune(xmlTextReader *reader, int prune)
+{
+    if ((reader == NULL) || (reader->ctxt == NULL) ||
+        (reader->doc != NULL) || (reader->flat) ||
+        (reader->mode != XML_TEXTREADER_MODE_INITIAL))
+        return(-1);
+
+#ifdef LIBXML_PATTERN_ENABLED
+    reader->patternPrune = (prune != 0);
+    return(0);
+#else
+    (void) prune;
+    return(-1);
+#endif
+}
+
 /**
  * @since 2.13.0
  *
@@ -20,17 +20,21 @@
 #ifdef LIBXML_REGEXP_ENABLED
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
 #include <libxml/tree.h>
+#include <libxml/hash.h>
 #include <libxml/parserInternals.h>
 #include <libxml/xmlregexp.h>
 #include <libxml/xmlautomata.h>
 
+#include "private/dict.h"
 #include "private/error.h"
 #include "private/memory.h"
 #include "private/regexp.h"
+#include "private/threads.h"
 
 #ifndef SIZE_MAX
 #define SIZE_MAX ((size_t) -1)
@@ -317,6 +321,10 @@ struct _xmlAutomata {
     int depth;
 };
 
+typedef struct _xmlRegDfa xmlRegDfa;
+typedef struct _xmlRegConfigMap xmlRegConfigMap;
+typedef struct _xmlRegNameTable xmlRegNameTable;
+
 struct _xmlRegexp {
     xmlChar *string;
     int nbStates;
@@ -335,6 +343,28 @@ struct _xmlRegexp {
     void **transdata;
     int nbstrings;
     xmlChar **stringMap;
+    /*
+     * Lazily built DFA for matching strings without backtracking
+     */
+    xmlRegDfa *dfa;
+    /*
+     * Configurations for the counting-set matcher
+     */
+    xmlRegConfigMap *countMap;
+    /*
+     * Strings of the compact form resolved through a dictionary
+     */
+    xmlRegNameTable *names;
+    /*
+     * ASCII character found in every matching string or 0
+     */
+    int required;
+    /*
+     * Regexps compiled from a string are shared through a global
+     * cache and freed when the last reference is dropped.
+     */
+    int cached;
+    int refCount;
 };
 
 typedef struct _xmlRegExecRollback xmlRegExecRollback;
@@ -396,6 +426,19 @@ struct _xmlRegExecCtxt {
     xmlChar *errString;		/* the string raising the error */
     int *errCounts;		/* counters at the error state */
     int nbPush;
+
+    int maxCounters;		/* capacity of the counter arrays */
+    int *spareCounts;		/* counters kept while comp has none */
+};
+
+/*
+ * Maximum number of execution contexts kept by a pool
+ */
+#define XML_REG_EXEC_POOL_MAX 64
+
+struct _xmlRegExecPool {
+    int nb;
+    xmlRegExecCtxtPtr tab[XML_REG_EXEC_POOL_MAX];
 };
 
 #define REGEXP_ALL_COUNTER	0x123456
@@ -408,6 +451,12 @@ static int xmlRegStrEqualWildcard(const xmlChar *expStr, const xmlChar *valStr);
 static int xmlRegCheckCharacter(xmlRegAtomPtr atom, int codepoint);
 static int xmlRegCheckCharacterRange(xmlRegAtomType type, int codepoint,
                   int neg, int start, int end, const xmlChar *blockName);
+static void xmlRegDfaFree(xmlRegDfa *dfa);
+static void xmlRegCountFree(xmlRegConfigMap *map);
+static void xmlRegNameTableFree(xmlRegNameTable *table);
+static int xmlRegNameTableFind(xmlRegexpPtr regexp, int state,
+                               const xmlChar *name, const xmlChar *ns,
+                               unsigned hashValue);
 
 /************************************************************************
  *									*
@@ -3270,7 +3319,7 @@ xmlFARegExecSave(xmlRegExecCtxtPtr exec) {
     if (exec->comp->nbCounters > 0) {
 	if (exec->rollbacks[exec->nbRollbacks].counts == NULL) {
 	    exec->rollbacks[exec->nbRollbacks].counts = (int *)
-		xmlMalloc(exec->comp->nbCounters * sizeof(int));
+		xmlMalloc(exec->maxCounters * sizeof(int));
 	    if (exec->rollbacks[exec->nbRollbacks].counts == NULL) {
 		exec->status = XML_REGEXP_OUT_OF_MEMORY;
 		return;
@@ -3332,6 +3381,7 @@ xmlFARegExec(xmlRegexpPtr comp, const xmlChar *content) {
     exec->transcount = 0;
     exec->inputStack = NULL;
     exec->inputStackMax = 0;
+    exec->maxCounters = comp->nbCounters;
     if (comp->nbCounters > 0) {
 	exec->counts = (int *) xmlMalloc(comp->nbCounters * sizeof(int));
 	if (exec->counts == NULL) {
@@ -3592,213 +3642,1561 @@ error:
 
 /************************************************************************
  *									*
- *	Progressive interface to the verifier one atom at a time	*
+ *	Configurations of an automaton					*
  *									*
  ************************************************************************/
 
-/**
- * Build a context used for progressive evaluation of a regexp.
- *
- * @deprecated Internal function, don't use.
- *
- * @param comp  a precompiled regular expression
- * @param callback  a callback function used for handling progresses in the
- *            automata matching phase
- * @param data  the context data associated to the callback in this context
- * @returns the new context
+/*
+ * Maximum number of NFA configurations
  */
-xmlRegExecCtxt *
-xmlRegNewExecCtxt(xmlRegexp *comp, xmlRegExecCallbacks callback, void *data) {
-    xmlRegExecCtxtPtr exec;
+#define XML_REG_MAX_CONFIGS 4096
 
-    if (comp == NULL)
-	return(NULL);
-    if ((comp->compact == NULL) && (comp->states == NULL))
-        return(NULL);
-    exec = (xmlRegExecCtxtPtr) xmlMalloc(sizeof(xmlRegExecCtxt));
-    if (exec == NULL)
-	return(NULL);
-    memset(exec, 0, sizeof(xmlRegExecCtxt));
-    exec->inputString = NULL;
-    exec->index = 0;
-    exec->determinist = 1;
-    exec->maxRollbacks = 0;
-    exec->nbRollbacks = 0;
-    exec->rollbacks = NULL;
-    exec->status = XML_REGEXP_OK;
-    exec->comp = comp;
-    if (comp->compact == NULL)
-	exec->state = comp->states[0];
-    exec->transno = 0;
-    exec->transcount = 0;
-    exec->callback = callback;
-    exec->data = data;
-    if (comp->nbCounters > 0) {
-        /*
-	 * For error handling, exec->counts is allocated twice the size
-	 * the second half is used to store the data in case of rollback
-	 */
-	exec->counts = (int *) xmlMalloc(comp->nbCounters * sizeof(int)
-	                                 * 2);
-	if (exec->counts == NULL) {
-	    xmlFree(exec);
-	    return(NULL);
-	}
-        memset(exec->counts, 0, comp->nbCounters * sizeof(int) * 2);
-	exec->errCounts = &exec->counts[comp->nbCounters];
-    } else {
-	exec->counts = NULL;
-	exec->errCounts = NULL;
-    }
-    exec->inputStackMax = 0;
-    exec->inputStackNr = 0;
-    exec->inputStack = NULL;
-    exec->errStateNo = -1;
-    exec->errString = NULL;
-    exec->nbPush = 0;
-    return(exec);
+/*
+ * The matchers without backtracking track sets of configurations.
+ * Configurations are the states of the automaton followed by the
+ * positions after 1 to max - 1 characters in transitions repeating
+ * a single-character atom like \d{3}.
+ */
+struct _xmlRegConfigMap {
+    int nbConfigs;
+    int *stateTrans;	/* first entry of each state in transBase */
+    int *transBase;	/* first configuration of repeating transitions */
+    xmlRegTransPtr *configTrans; /* transition of the positions */
+    int *configCount;	/* characters consumed at the positions */
+};
+
+static void
+xmlRegConfigMapClear(xmlRegConfigMap *map) {
+    xmlFree(map->stateTrans);
+    xmlFree(map->transBase);
+    xmlFree(map->configTrans);
+    xmlFree(map->configCount);
+    memset(map, 0, sizeof(*map));
 }
 
 /**
- * Free the structures associated to a regular expression evaluation context.
- *
- * @deprecated Internal function, don't use.
+ * Number the configurations of an automaton. Repeating atoms must
+ * consume at least one character.
  *
- * @param exec  a regular expression evaluation context
+ * @param comp  the compiled regexp
+ * @param map  the map to fill
+ * @returns 0 on success or -1 if the automaton has too many
+ * configurations, an unsupported atom or a memory allocation failed.
  */
-void
-xmlRegFreeExecCtxt(xmlRegExecCtxt *exec) {
-    if (exec == NULL)
-	return;
+static int
+xmlRegConfigMapInit(xmlRegexpPtr comp, xmlRegConfigMap *map) {
+    xmlRegStatePtr state;
+    xmlRegTransPtr trans;
+    xmlRegAtomPtr atom;
+    int i, j, k, nbTrans = 0, nbConfigs, base, off;
 
-    if (exec->rollbacks != NULL) {
-	if (exec->counts != NULL) {
-	    int i;
+    memset(map, 0, sizeof(*map));
 
-	    for (i = 0;i < exec->maxRollbacks;i++)
-		if (exec->rollbacks[i].counts != NULL)
-		    xmlFree(exec->rollbacks[i].counts);
-	}
-	xmlFree(exec->rollbacks);
+    nbConfigs = comp->nbStates;
+    for (i = 0; i < comp->nbStates; i++) {
+        state = comp->states[i];
+        if (state == NULL)
+            continue;
+        nbTrans += state->nbTrans;
+        for (j = 0; j < state->nbTrans; j++) {
+            trans = &state->trans[j];
+            atom = trans->atom;
+            if ((trans->to < 0) || (atom == NULL) || (atom->max <= 0))
+                continue;
+            if ((atom->min < 1) || (atom->min > atom->max) ||
+                (atom->max > XML_REG_MAX_CONFIGS))
+                return(-1);
+            nbConfigs += atom->max - 1;
+            if (nbConfigs > XML_REG_MAX_CONFIGS)
+                return(-1);
+        }
     }
-    if (exec->counts != NULL)
-	xmlFree(exec->counts);
-    if (exec->inputStack != NULL) {
-	int i;
 
-	for (i = 0;i < exec->inputStackNr;i++) {
-	    if (exec->inputStack[i].value != NULL)
-		xmlFree(exec->inputStack[i].value);
-	}
-	xmlFree(exec->inputStack);
+    map->nbConfigs = nbConfigs;
+    map->stateTrans = xmlMalloc(comp->nbStates * sizeof(int));
+    map->transBase = xmlMalloc((nbTrans + 1) * sizeof(int));
+    map->configTrans = xmlMalloc((nbConfigs - comp->nbStates + 1) *
+                                 sizeof(xmlRegTransPtr));
+    map->configCount = xmlMalloc((nbConfigs - comp->nbStates + 1) *
+                                 sizeof(int));
+    if ((map->stateTrans == NULL) || (map->transBase == NULL) ||
+        (map->configTrans == NULL) || (map->configCount == NULL)) {
+        xmlRegConfigMapClear(map);
+        return(-1);
     }
-    if (exec->errString != NULL)
-        xmlFree(exec->errString);
-    xmlFree(exec);
-}
 
-static int
-xmlRegExecSetErrString(xmlRegExecCtxtPtr exec, const xmlChar *value) {
-    if (exec->errString != NULL)
-        xmlFree(exec->errString);
-    if (value == NULL) {
-        exec->errString = NULL;
-    } else {
-        exec->errString = xmlStrdup(value);
-        if (exec->errString == NULL) {
-            exec->status = XML_REGEXP_OUT_OF_MEMORY;
-            return(-1);
+    base = comp->nbStates;
+    off = 0;
+    for (i = 0; i < comp->nbStates; i++) {
+        map->stateTrans[i] = off;
+        state = comp->states[i];
+        if (state == NULL)
+            continue;
+        for (j = 0; j < state->nbTrans; j++) {
+            trans = &state->trans[j];
+            map->transBase[off + j] = -1;
+            if ((trans->to < 0) || (trans->atom == NULL) ||
+                (trans->atom->max <= 1))
+                continue;
+            map->transBase[off + j] = base;
+            for (k = 1; k < trans->atom->max; k++) {
+                map->configTrans[base - comp->nbStates] = trans;
+                map->configCount[base - comp->nbStates] = k;
+                base++;
+            }
         }
+        off += state->nbTrans;
     }
+
     return(0);
 }
 
+/************************************************************************
+ *									*
+ *	Lazy DFA, matching strings without backtracking			*
+ *									*
+ ************************************************************************/
+
+/*
+ * Maximum number of DFA states cached per regexp. If more states
+ * are needed, the backtracking matcher is used.
+ */
+#define XML_REG_DFA_MAX_STATES 500
+/*
+ * Maximum number of states for partially read UTF-8 sequences. If
+ * more are needed, the rest of a character is decoded directly.
+ */
+#define XML_REG_DFA_MAX_PARTIAL 256
+#define XML_REG_DFA_HASH_SIZE 1024
+
+/* Returned if the DFA can't handle an input */
+#define XML_REG_DFA_FALLBACK (-100)
+
+typedef struct _xmlRegDfaState xmlRegDfaState;
+
+struct _xmlRegDfaState {
+    int *configs;	/* sorted NFA configurations */
+    int nbConfigs;
+    unsigned hash;
+    int final;
+    int dead;		/* no configurations left */
+    /* Partially read UTF-8 sequences */
+    int parent;		/* state before the sequence or -1 */
+    int partial;	/* bits read so far */
+    int needed;		/* continuation bytes left */
+    int min;		/* smallest codepoint of this length */
+    int next[256];	/* next DFA state + 1 or 0 for each byte, atomic */
+};
+
+/*
+ * The DFA states are sets of NFA configurations, see xmlRegConfigMap.
+ *
+ * Transitions are made on bytes. Reading the lead byte of a UTF-8
+ * sequence moves to a partial state which remembers the bits read
+ * so far, the continuation bytes move on to further partial states
+ * and the last one computes the transition on the whole character.
+ * Once the cache is warm, matching is a walk through the tables.
+ *
+ * The cache is shared by all users of a regexp. Cache misses are
+ * computed under a mutex. New states are filled in before the
+ * transitions leading to them are published with release stores,
+ * and the state table is allocated once at its maximum size, so
+ * cache hits only need acquire loads and don't lock. Without atomics
+ * the whole match holds the mutex.
+ */
+struct _xmlRegDfa {
+    xmlMutex lock;
+    int ready;		/* initial state exists, atomic */
+
+    xmlRegConfigMap map;
+
+    int nbStates;
+    int nbPartial;
+    int maxStates;
+    xmlRegDfaState **states;
+    int *hashTab;	/* DFA state + 1 or 0 */
+
+    /* Scratch space for computing transitions */
+    unsigned *mark;
+    unsigned gen;
+    int *work;
+};
+
 static void
-xmlFARegExecSaveInputString(xmlRegExecCtxtPtr exec, const xmlChar *value,
-	                    void *data) {
-    if (exec->inputStackNr + 1 >= exec->inputStackMax) {
-	xmlRegInputTokenPtr tmp;
-        int newSize;
+xmlRegDfaFree(xmlRegDfa *dfa) {
+    int i;
 
-        newSize = xmlGrowCapacity(exec->inputStackMax, sizeof(tmp[0]),
-                                  4, XML_MAX_ITEMS);
-	if (newSize < 0) {
-            exec->status = XML_REGEXP_OUT_OF_MEMORY;
-	    return;
-	}
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-        if (newSize < 2)
-            newSize = 2;
-#endif
-	tmp = xmlRealloc(exec->inputStack, newSize * sizeof(tmp[0]));
-	if (tmp == NULL) {
-            exec->status = XML_REGEXP_OUT_OF_MEMORY;
-	    return;
-	}
-	exec->inputStack = tmp;
-	exec->inputStackMax = newSize;
-    }
-    if (value == NULL) {
-        exec->inputStack[exec->inputStackNr].value = NULL;
-    } else {
-        exec->inputStack[exec->inputStackNr].value = xmlStrdup(value);
-        if (exec->inputStack[exec->inputStackNr].value == NULL) {
-            exec->status = XML_REGEXP_OUT_OF_MEMORY;
-            return;
+    if (dfa == NULL)
+        return;
+    for (i = 0; i < dfa->nbStates; i++) {
+        xmlFree(dfa->states[i]->configs);
+        xmlFree(dfa->states[i]);
+    }
+    xmlFree(dfa->states);
+    xmlFree(dfa->hashTab);
+    xmlRegConfigMapClear(&dfa->map);
+    xmlFree(dfa->mark);
+    xmlFree(dfa->work);
+    xmlCleanupMutex(&dfa->lock);
+    xmlFree(dfa);
+}
+
+/**
+ * Prepare a lazy DFA for a regexp. This only works for automata
+ * without counters where every transition consumes characters.
+ *
+ * @param comp  the compiled regexp
+ * @returns the DFA or NULL if the regexp isn't supported or a memory
+ * allocation failed.
+ */
+static xmlRegDfa *
+xmlRegDfaNew(xmlRegexpPtr comp) {
+    xmlRegDfa *dfa;
+    xmlRegStatePtr state;
+    xmlRegTransPtr trans;
+    xmlRegAtomPtr atom;
+    int i, j, nbConfigs;
+
+    if ((comp->nbCounters > 0) || (comp->nbStates <= 0) ||
+        (comp->states == NULL) || (comp->states[0] == NULL))
+        return(NULL);
+
+    for (i = 0; i < comp->nbStates; i++) {
+        state = comp->states[i];
+        if (state == NULL)
+            continue;
+        for (j = 0; j < state->nbTrans; j++) {
+            trans = &state->trans[j];
+            if (trans->to < 0)
+                continue;
+            atom = trans->atom;
+            if ((atom == NULL) || (trans->count >= 0) ||
+                (trans->counter >= 0) ||
+                (atom->type == XML_REGEXP_EPSILON) ||
+                (atom->type == XML_REGEXP_SUBREG) ||
+                (atom->type == XML_REGEXP_STRING))
+                return(NULL);
         }
     }
-    exec->inputStack[exec->inputStackNr].data = data;
-    exec->inputStackNr++;
-    exec->inputStack[exec->inputStackNr].value = NULL;
-    exec->inputStack[exec->inputStackNr].data = NULL;
+
+    dfa = xmlMalloc(sizeof(*dfa));
+    if (dfa == NULL)
+        return(NULL);
+    memset(dfa, 0, sizeof(*dfa));
+    if (xmlRegConfigMapInit(comp, &dfa->map) < 0) {
+        xmlFree(dfa);
+        return(NULL);
+    }
+    nbConfigs = dfa->map.nbConfigs;
+    dfa->mark = xmlMalloc(nbConfigs * sizeof(unsigned));
+    dfa->work = xmlMalloc(nbConfigs * sizeof(int));
+    if ((dfa->mark == NULL) || (dfa->work == NULL)) {
+        xmlRegConfigMapClear(&dfa->map);
+        xmlFree(dfa->mark);
+        xmlFree(dfa->work);
+        xmlFree(dfa);
+        return(NULL);
+    }
+    memset(dfa->mark, 0, nbConfigs * sizeof(unsigned));
+
+    xmlInitMutex(&dfa->lock);
+    return(dfa);
 }
 
 /**
- * Checks if both strings are equal or have the same content. "*"
- * can be used as a wildcard in `valStr`; "|" is used as a separator of
- * substrings in both `expStr` and `valStr`.
+ * Allocate a DFA state and make room for it in the state table.
+ * The caller must have suspended the memory budget.
  *
- * @param expStr  the string to be evaluated
- * @param valStr  the validation string
- * @returns 1 if the comparison is satisfied and the number of substrings
- * is equal, 0 otherwise.
+ * @param dfa  the DFA
+ * @returns the state or NULL if a memory allocation failed.
  */
+static xmlRegDfaState *
+xmlRegDfaNewState(xmlRegDfa *dfa) {
+    xmlRegDfaState *state;
+
+    /* Never reallocated, readers access it without lock */
+    if (dfa->states == NULL) {
+        dfa->maxStates = XML_REG_DFA_MAX_STATES + XML_REG_DFA_MAX_PARTIAL;
+        dfa->states = xmlMalloc(dfa->maxStates * sizeof(dfa->states[0]));
+        if (dfa->states == NULL) {
+            dfa->maxStates = 0;
+            return(NULL);
+        }
+    }
+    if (dfa->nbStates >= dfa->maxStates)
+        return(NULL);
+
+    state = xmlMalloc(sizeof(*state));
+    if (state == NULL)
+        return(NULL);
+    memset(state, 0, sizeof(*state));
+    state->parent = -1;
+    return(state);
+}
 
 static int
-xmlRegStrEqualWildcard(const xmlChar *expStr, const xmlChar *valStr) {
-    if (expStr == valStr) return(1);
-    if (expStr == NULL) return(0);
-    if (valStr == NULL) return(0);
-    do {
-	/*
-	* Eval if we have a wildcard for the current item.
-	*/
-        if (*expStr != *valStr) {
-	    /* if one of them starts with a wildcard make valStr be it */
-	    if (*valStr == '*') {
-	        const xmlChar *tmp;
+xmlRegDfaCompareConfigs(const void *a, const void *b) {
+    int c1 = *(const int *) a;
+    int c2 = *(const int *) b;
 
-		tmp = valStr;
-		valStr = expStr;
-		expStr = tmp;
-	    }
-	    if ((*valStr != 0) && (*expStr != 0) && (*expStr++ == '*')) {
-		do {
-		    if (*valStr == XML_REG_STRING_SEPARATOR)
-			break;
-		    valStr++;
-		} while (*valStr != 0);
-		continue;
-	    } else
-		return(0);
-	}
-	expStr++;
-	valStr++;
-    } while (*valStr != 0);
-    if (*expStr != 0)
-	return (0);
-    else
-	return (1);
+    return((c1 > c2) - (c1 < c2));
+}
+
+/**
+ * Find or add the DFA state for the set of configurations in the
+ * scratch space.
+ *
+ * @param comp  the compiled regexp
+ * @param dfa  the DFA
+ * @param nbConfigs  the number of configurations
+ * @returns the index of the DFA state, XML_REG_DFA_FALLBACK if the
+ * cache is full or XML_REGEXP_OUT_OF_MEMORY.
+ */
+static int
+xmlRegDfaLookup(xmlRegexpPtr comp, xmlRegDfa *dfa, int nbConfigs) {
+    xmlRegDfaState *state;
+    xmlMemBudget *budget;
+    int *configs = dfa->work;
+    unsigned hash = 2166136261u;
+    int i, idx;
+
+    if (nbConfigs > 1)
+        qsort(configs, nbConfigs, sizeof(int), xmlRegDfaCompareConfigs);
+    for (i = 0; i < nbConfigs; i++)
+        hash = (hash ^ (unsigned) configs[i]) * 16777619u;
+
+    idx = hash & (XML_REG_DFA_HASH_SIZE - 1);
+    if (dfa->hashTab != NULL) {
+        while (dfa->hashTab[idx] != 0) {
+            state = dfa->states[dfa->hashTab[idx] - 1];
+            if ((state->hash == hash) && (state->nbConfigs == nbConfigs) &&
+                (memcmp(state->configs, configs,
+                        nbConfigs * sizeof(int)) == 0))
+                return(dfa->hashTab[idx] - 1);
+            idx = (idx + 1) & (XML_REG_DFA_HASH_SIZE - 1);
+        }
+    }
+
+    if (dfa->nbStates - dfa->nbPartial >= XML_REG_DFA_MAX_STATES)
+        return(XML_REG_DFA_FALLBACK);
+
+    /* The cache outlives the budget of the current caller. */
+    budget = xmlMemBudgetSuspend();
+
+    if (dfa->hashTab == NULL) {
+        dfa->hashTab = xmlMalloc(XML_REG_DFA_HASH_SIZE * sizeof(int));
+        if (dfa->hashTab == NULL)
+            goto error;
+        memset(dfa->hashTab, 0, XML_REG_DFA_HASH_SIZE * sizeof(int));
+    }
+    state = xmlRegDfaNewState(dfa);
+    if (state == NULL)
+        goto error;
+    state->configs = xmlMalloc((nbConfigs + 1) * sizeof(int));
+    if (state->configs == NULL) {
+        xmlFree(state);
+        goto error;
+    }
+    memcpy(state->configs, configs, nbConfigs * sizeof(int));
+    state->nbConfigs = nbConfigs;
+    state->hash = hash;
+    state->dead = (nbConfigs == 0);
+    for (i = 0; i < nbConfigs; i++) {
+        if ((configs[i] < comp->nbStates) &&
+            (comp->states[configs[i]]->type == XML_REGEXP_FINAL_STATE)) {
+            state->final = 1;
+            break;
+        }
+    }
+
+    xmlMemBudgetLeave(budget);
+
+    dfa->hashTab[idx] = dfa->nbStates + 1;
+    dfa->states[dfa->nbStates] = state;
+    return(dfa->nbStates++);
+
+error:
+    xmlMemBudgetLeave(budget);
+    return(XML_REGEXP_OUT_OF_MEMORY);
+}
+
+#define XML_REG_DFA_ADD(config) \
+    do { \
+        int c_ = (config); \
+        if (((c_ >= comp->nbStates) || (comp->states[c_] != NULL)) && \
+            (dfa->mark[c_] != dfa->gen)) { \
+            dfa->mark[c_] = dfa->gen; \
+            dfa->work[n++] = c_; \
+        } \
+    } while (0)
+
+/**
+ * Compute the transition of a DFA state on a character.
+ *
+ * @param comp  the compiled regexp
+ * @param dfa  the DFA
+ * @param from  the index of the DFA state
+ * @param codepoint  the character
+ * @returns the index of the next DFA state or a negative value if
+ * the DFA can't be used.
+ */
+static int
+xmlRegDfaStep(xmlRegexpPtr comp, xmlRegDfa *dfa, int from, int codepoint) {
+    xmlRegDfaState *state = dfa->states[from];
+    xmlRegTransPtr trans;
+    int i, j, n = 0, ret;
+
+    dfa->gen++;
+    if (dfa->gen == 0) {
+        memset(dfa->mark, 0, dfa->map.nbConfigs * sizeof(unsigned));
+        dfa->gen = 1;
+    }
+
+    for (i = 0; i < state->nbConfigs; i++) {
+        int config = state->configs[i];
+
+        if (config < comp->nbStates) {
+            xmlRegStatePtr nfaState = comp->states[config];
+            const int *bases =
+                &dfa->map.transBase[dfa->map.stateTrans[config]];
+
+            for (j = 0; j < nfaState->nbTrans; j++) {
+                trans = &nfaState->trans[j];
+                if (trans->to < 0)
+                    continue;
+                ret = xmlRegCheckCharacter(trans->atom, codepoint);
+                if (ret < 0)
+                    return(XML_REG_DFA_FALLBACK);
+                if (ret == 0)
+                    continue;
+                if ((trans->atom->max == 0) || (trans->atom->min <= 1))
+                    XML_REG_DFA_ADD(trans->to);
+                if (trans->atom->max > 1)
+                    XML_REG_DFA_ADD(bases[j]);
+            }
+        } else {
+            int count;
+
+            trans = dfa->map.configTrans[config - comp->nbStates];
+            count = dfa->map.configCount[config - comp->nbStates] + 1;
+            ret = xmlRegCheckCharacter(trans->atom, codepoint);
+            if (ret < 0)
+                return(XML_REG_DFA_FALLBACK);
+            if (ret == 0)
+                continue;
+            if (count >= trans->atom->min)
+                XML_REG_DFA_ADD(trans->to);
+            if (count < trans->atom->max)
+                XML_REG_DFA_ADD(config + 1);
+        }
+    }
+
+    return(xmlRegDfaLookup(comp, dfa, n));
+}
+
+/**
+ * Add a state for a partially read UTF-8 sequence. These states
+ * aren't shared, so they're only reachable from the byte which
+ * created them.
+ *
+ * @param dfa  the DFA
+ * @param parent  the state before the sequence
+ * @param partial  the bits read so far
+ * @param needed  the number of continuation bytes left
+ * @param min  the smallest valid codepoint
+ * @returns the index of the new state, XML_REG_DFA_FALLBACK if too
+ * many partial states exist or XML_REGEXP_OUT_OF_MEMORY.
+ */
+static int
+xmlRegDfaAddPartial(xmlRegDfa *dfa, int parent, int partial, int needed,
+                    int min) {
+    xmlRegDfaState *state;
+    xmlMemBudget *budget;
+
+    if (dfa->nbPartial >= XML_REG_DFA_MAX_PARTIAL)
+        return(XML_REG_DFA_FALLBACK);
+
+    budget = xmlMemBudgetSuspend();
+    state = xmlRegDfaNewState(dfa);
+    xmlMemBudgetLeave(budget);
+    if (state == NULL)
+        return(XML_REGEXP_OUT_OF_MEMORY);
+    state->parent = parent;
+    state->partial = partial;
+    state->needed = needed;
+    state->min = min;
+
+    dfa->nbPartial++;
+    dfa->states[dfa->nbStates] = state;
+    return(dfa->nbStates++);
+}
+
+/* Cache misses lock unless the whole match holds the lock */
+#ifdef XML_HAVE_ATOMICS
+  #define XML_REG_DFA_MISS_LOCK(dfa) xmlMutexLock(&(dfa)->lock)
+  #define XML_REG_DFA_MISS_UNLOCK(dfa) xmlMutexUnlock(&(dfa)->lock)
+#else
+  #define XML_REG_DFA_MISS_LOCK(dfa)
+  #define XML_REG_DFA_MISS_UNLOCK(dfa)
+#endif
+
+/**
+ * Compute and cache the transition of a DFA state on the next byte
+ * of the input. If no more partial states can be added, the rest of
+ * a UTF-8 sequence is decoded and skipped without caching. Must be
+ * called with the lock held.
+ *
+ * @param comp  the compiled regexp
+ * @param dfa  the DFA
+ * @param from  the index of the DFA state
+ * @param content  pointer to the input, advanced past the bytes read
+ * @returns the index of the next DFA state or a negative value if
+ * the DFA can't be used.
+ */
+static int
+xmlRegDfaMiss(xmlRegexpPtr comp, xmlRegDfa *dfa, int from,
+              const xmlChar **content) {
+    xmlRegDfaState *state = dfa->states[from];
+    const xmlChar *cur = *content;
+    int c = *cur;
+    int parent, partial, needed, min, next;
+
+    /* Another thread could have added the transition meanwhile */
+    next = xmlAtomicLoadInt(&state->next[c]) - 1;
+    if (next >= 0) {
+        *content = cur + 1;
+        return(next);
+    }
+
+    if (state->parent < 0) {
+        if (c < 0x80) {
+            next = xmlRegDfaStep(comp, dfa, from, c);
+            if (next >= 0) {
+                xmlAtomicStoreInt(&state->next[c], next + 1);
+                *content = cur + 1;
+            }
+            return(next);
+        }
+        if ((c < 0xC2) || (c > 0xF4))
+            return(XML_REG_DFA_FALLBACK);
+        needed = (c < 0xE0) ? 1 : (c < 0xF0) ? 2 : 3;
+        partial = c & (0x3F >> needed);
+        min = (needed == 1) ? 0x80 : (needed == 2) ? 0x800 : 0x10000;
+        parent = from;
+
+        next = xmlRegDfaAddPartial(dfa, parent, partial, needed, min);
+        if (next >= 0) {
+            xmlAtomicStoreInt(&state->next[c], next + 1);
+            *content = cur + 1;
+            return(next);
+        }
+        if (next != XML_REG_DFA_FALLBACK)
+            return(next);
+    } else {
+        if ((c & 0xC0) != 0x80)
+            return(XML_REG_DFA_FALLBACK);
+        parent = state->parent;
+        partial = (state->partial << 6) | (c & 0x3F);
+        needed = state->needed - 1;
+        min = state->min;
+
+        if (needed > 0) {
+            next = xmlRegDfaAddPartial(dfa, parent, partial, needed, min);
+            if (next >= 0) {
+                xmlAtomicStoreInt(&state->next[c], next + 1);
+                *content = cur + 1;
+                return(next);
+            }
+            if (next != XML_REG_DFA_FALLBACK)
+                return(next);
+        } else {
+            if ((partial < min) ||
+                ((partial >= 0xD800) && (partial < 0xE000)) ||
+                (partial >= 0x110000))
+                return(XML_REG_DFA_FALLBACK);
+            next = xmlRegDfaStep(comp, dfa, parent, partial);
+            if (next >= 0) {
+                xmlAtomicStoreInt(&state->next[c], next + 1);
+                *content = cur + 1;
+            }
+            return(next);
+        }
+    }
+
+    /* Out of partial states, decode the rest of the character. */
+    while (needed > 0) {
+        cur++;
+        if ((*cur & 0xC0) != 0x80)
+            return(XML_REG_DFA_FALLBACK);
+        partial = (partial << 6) | (*cur & 0x3F);
+        needed--;
+    }
+    if ((partial < min) ||
+        ((partial >= 0xD800) && (partial < 0xE000)) ||
+        (partial >= 0x110000))
+        return(XML_REG_DFA_FALLBACK);
+    next = xmlRegDfaStep(comp, dfa, parent, partial);
+    if (next >= 0)
+        *content = cur + 1;
+    return(next);
+}
+
+/**
+ * Match a string with the lazy DFA.
+ *
+ * @param comp  the compiled regexp
+ * @param content  the string
+ * @returns 1 if the string matches, 0 if not, XML_REG_DFA_FALLBACK if
+ * the backtracking matcher must be used or another negative value
+ * in case of error.
+ */
+static int
+xmlRegDfaExec(xmlRegexpPtr comp, const xmlChar *content) {
+    xmlRegDfa *dfa = comp->dfa;
+    xmlRegDfaState *state;
+    int cur, next, ret;
+
+#ifndef XML_HAVE_ATOMICS
+    xmlMutexLock(&dfa->lock);
+#endif
+
+    if (xmlAtomicLoadInt(&dfa->ready) == 0) {
+        XML_REG_DFA_MISS_LOCK(dfa);
+        if (dfa->nbStates == 0) {
+            dfa->work[0] = 0;
+            ret = xmlRegDfaLookup(comp, dfa, 1);
+            if (ret >= 0)
+                xmlAtomicStoreInt(&dfa->ready, 1);
+        } else {
+            ret = 0;
+        }
+        XML_REG_DFA_MISS_UNLOCK(dfa);
+        if (ret < 0)
+            goto done;
+    }
+
+    cur = 0;
+    state = dfa->states[0];
+    while (*content != 0) {
+        next = xmlAtomicLoadInt(&state->next[*content]) - 1;
+        if (next >= 0) {
+            content++;
+        } else {
+            XML_REG_DFA_MISS_LOCK(dfa);
+            next = xmlRegDfaMiss(comp, dfa, cur, &content);
+            XML_REG_DFA_MISS_UNLOCK(dfa);
+            if (next < 0) {
+                ret = next;
+                goto done;
+            }
+        }
+
+        cur = next;
+        state = dfa->states[cur];
+        if (state->dead) {
+            ret = 0;
+            goto done;
+        }
+    }
+
+    /* Truncated UTF-8 sequence */
+    if (state->parent >= 0)
+        ret = XML_REG_DFA_FALLBACK;
+    else
+        ret = state->final;
+
+done:
+#ifndef XML_HAVE_ATOMICS
+    xmlMutexUnlock(&dfa->lock);
+#endif
+    return(ret);
+}
+
+/************************************************************************
+ *									*
+ *	Counting sets, matching regexps with a counter			*
+ *									*
+ ************************************************************************/
+
+/*
+ * Regexps like (a|b){1,5000} repeat a group with a counter. The
+ * backtracking matcher explores the possible counter values one by
+ * one which can take exponential time. The counting-set matcher
+ * tracks configurations like the lazy DFA and attaches the set of
+ * possible counter values to each of them, stored as sorted and
+ * disjoint intervals. Incrementing the counter shifts the intervals
+ * and leaving the group resets the set to {0}, so the work per
+ * character doesn't depend on the bounds of the counter.
+ *
+ * Only automata with a single counter are supported.
+ */
+
+/* Maximum number of intervals in a set */
+#define XML_REG_COUNT_MAX_INTERVALS 256
+
+typedef struct {
+    int nbIntervals;
+    int maxIntervals;
+    int *bounds;	/* pairs of first and last value */
+} xmlRegCountSet;
+
+typedef struct {
+    xmlRegCountSet *sets;
+    int *active;	/* configurations with non-empty sets */
+    int nbActive;
+} xmlRegCountGen;
+
+/**
+ * Prepare the counting-set matcher for a regexp.
+ *
+ * @param comp  the compiled regexp
+ * @returns the configuration map or NULL if the regexp isn't
+ * supported or a memory allocation failed.
+ */
+static xmlRegConfigMap *
+xmlRegCountNew(xmlRegexpPtr comp) {
+    xmlRegConfigMap *map;
+    xmlRegStatePtr state;
+    xmlRegTransPtr trans;
+    xmlRegAtomPtr atom;
+    int i, j;
+
+    if ((comp->nbCounters != 1) || (comp->nbStates <= 0) ||
+        (comp->states == NULL) || (comp->states[0] == NULL) ||
+        (comp->counters[0].min < 0) ||
+        (comp->counters[0].max < comp->counters[0].min) ||
+        (comp->counters[0].max == INT_MAX))
+        return(NULL);
+
+    for (i = 0; i < comp->nbStates; i++) {
+        state = comp->states[i];
+        if (state == NULL)
+            continue;
+        for (j = 0; j < state->nbTrans; j++) {
+            trans = &state->trans[j];
+            if (trans->to < 0)
+                continue;
+            if ((trans->to >= comp->nbStates) ||
+                (comp->states[trans->to] == NULL))
+                return(NULL);
+            atom = trans->atom;
+            if (atom == NULL) {
+                /* Only epsilon transitions leaving the group */
+                if (trans->count != 0)
+                    return(NULL);
+            } else if ((trans->count >= 0) ||
+                       (atom->type == XML_REGEXP_EPSILON) ||
+                       (atom->type == XML_REGEXP_SUBREG) ||
+                       (atom->type == XML_REGEXP_STRING)) {
+                return(NULL);
+            }
+        }
+    }
+
+    map = xmlMalloc(sizeof(*map));
+    if (map == NULL)
+        return(NULL);
+    if (xmlRegConfigMapInit(comp, map) < 0) {
+        xmlFree(map);
+        return(NULL);
+    }
+
+    return(map);
+}
+
+static void
+xmlRegCountFree(xmlRegConfigMap *map) {
+    if (map == NULL)
+        return;
+    xmlRegConfigMapClear(map);
+    xmlFree(map);
+}
+
+/**
+ * Add the values from `min` to `max` to the set of a configuration.
+ *
+ * @param gen  the generation
+ * @param config  the configuration
+ * @param min  the smallest value
+ * @param max  the largest value
+ * @returns 1 if the set changed, 0 if not, XML_REG_DFA_FALLBACK if
+ * the set has too many intervals or XML_REGEXP_OUT_OF_MEMORY.
+ */
+static int
+xmlRegCountAdd(xmlRegCountGen *gen, int config, int min, int max) {
+    xmlRegCountSet *set = &gen->sets[config];
+    int *b = set->bounds;
+    int n = set->nbIntervals;
+    int i, j;
+
+    if (n == 0)
+        gen->active[gen->nbActive++] = config;
+
+    /* First interval which ends at or after min - 1 */
+    for (i = 0; i < n; i++) {
+        if (b[2 * i + 1] >= min - 1)
+            break;
+    }
+    if ((i < n) && (b[2 * i] <= min) && (b[2 * i + 1] >= max))
+        return(0);
+
+    /* Merge with overlapping or adjacent intervals */
+    for (j = i; j < n; j++) {
+        if (b[2 * j] > max + 1)
+            break;
+    }
+    if (j > i) {
+        if (b[2 * i] < min)
+            min = b[2 * i];
+        if (b[2 * (j - 1) + 1] > max)
+            max = b[2 * (j - 1) + 1];
+        b[2 * i] = min;
+        b[2 * i + 1] = max;
+        memmove(&b[2 * (i + 1)], &b[2 * j], (n - j) * 2 * sizeof(int));
+        set->nbIntervals -= j - i - 1;
+        return(1);
+    }
+
+    if (n >= set->maxIntervals) {
+        int newSize;
+
+        newSize = xmlGrowCapacity(set->maxIntervals, 2 * sizeof(int),
+                                  2, XML_REG_COUNT_MAX_INTERVALS);
+        if (newSize < 0)
+            return(XML_REG_DFA_FALLBACK);
+        b = xmlRealloc(set->bounds, newSize * 2 * sizeof(int));
+        if (b == NULL)
+            return(XML_REGEXP_OUT_OF_MEMORY);
+        set->bounds = b;
+        set->maxIntervals = newSize;
+    }
+    memmove(&b[2 * (i + 1)], &b[2 * i], (n - i) * 2 * sizeof(int));
+    b[2 * i] = min;
+    b[2 * i + 1] = max;
+    set->nbIntervals++;
+    return(1);
+}
+
+/**
+ * Add the values of a set between `min` and `max`, shifted by
+ * `shift`, to the set of a configuration.
+ *
+ * @param gen  the generation
+ * @param config  the configuration
+ * @param from  the source set
+ * @param min  the smallest value to copy
+ * @param max  the largest value to copy
+ * @param shift  0 or 1 to increment the counter
+ * @returns 0 or a negative error code.
+ */
+static int
+xmlRegCountAddSet(xmlRegCountGen *gen, int config,
+                  const xmlRegCountSet *from, int min, int max,
+                  int shift) {
+    int i, lo, hi, ret;
+
+    for (i = 0; i < from->nbIntervals; i++) {
+        lo = from->bounds[2 * i];
+        hi = from->bounds[2 * i + 1];
+        if (lo < min)
+            lo = min;
+        if (hi > max)
+            hi = max;
+        if (lo > hi)
+            continue;
+        ret = xmlRegCountAdd(gen, config, lo + shift, hi + shift);
+        if (ret < 0)
+            return(ret);
+    }
+
+    return(0);
+}
+
+static int
+xmlRegCountIntersects(const xmlRegCountSet *set, int min, int max) {
+    int i;
+
+    for (i = 0; i < set->nbIntervals; i++) {
+        if ((set->bounds[2 * i] <= max) && (set->bounds[2 * i + 1] >= min))
+            return(1);
+    }
+
+    return(0);
+}
+
+/**
+ * Follow the epsilon transitions leaving the counted group until
+ * no set changes. They're only taken if the counter is in range and
+ * reset it.
+ *
+ * @param comp  the compiled regexp
+ * @param gen  the generation
+ * @returns 0 or a negative error code.
+ */
+static int
+xmlRegCountClosure(xmlRegexpPtr comp, xmlRegCountGen *gen) {
+    xmlRegCounterPtr counter = &comp->counters[0];
+    xmlRegStatePtr state;
+    xmlRegTransPtr trans;
+    int i, j, max, ret, changed;
+
+    do {
+        changed = 0;
+        for (i = 0; i < gen->nbActive; i++) {
+            int config = gen->active[i];
+
+            if (config >= comp->nbStates)
+                continue;
+            state = comp->states[config];
+            for (j = 0; j < state->nbTrans; j++) {
+                trans = &state->trans[j];
+                if ((trans->to < 0) || (trans->atom != NULL))
+                    continue;
+                max = counter->max;
+                if (trans->counter >= 0)
+                    max--;
+                if (!xmlRegCountIntersects(&gen->sets[config],
+                                           counter->min, max))
+                    continue;
+                ret = xmlRegCountAdd(gen, trans->to, 0, 0);
+                if (ret < 0)
+                    return(ret);
+                changed |= ret;
+            }
+        }
+    } while (changed);
+
+    return(0);
+}
+
+/**
+ * Match a string with the counting-set matcher.
+ *
+ * @param comp  the compiled regexp
+ * @param content  the string
+ * @returns 1 if the string matches, 0 if not, XML_REG_DFA_FALLBACK if
+ * the backtracking matcher must be used or another negative value
+ * in case of error.
+ */
+static int
+xmlRegCountExec(xmlRegexpPtr comp, const xmlChar *content) {
+    xmlRegConfigMap *map = comp->countMap;
+    xmlRegCounterPtr counter = &comp->counters[0];
+    xmlRegCountGen gens[2], *cur, *next, *tmp;
+    xmlRegCountSet *set;
+    xmlRegTransPtr trans;
+    int nbConfigs = map->nbConfigs;
+    int i, j, len, codepoint, ret;
+
+    memset(gens, 0, sizeof(gens));
+    for (i = 0; i < 2; i++) {
+        gens[i].sets = xmlMalloc(nbConfigs * sizeof(xmlRegCountSet));
+        gens[i].active = xmlMalloc(nbConfigs * sizeof(int));
+        if ((gens[i].sets == NULL) || (gens[i].active == NULL)) {
+            ret = XML_REGEXP_OUT_OF_MEMORY;
+            goto done;
+        }
+        memset(gens[i].sets, 0, nbConfigs * sizeof(xmlRegCountSet));
+    }
+    cur = &gens[0];
+    next = &gens[1];
+
+    ret = xmlRegCountAdd(cur, 0, 0, 0);
+    if (ret >= 0)
+        ret = xmlRegCountClosure(comp, cur);
+    if (ret < 0)
+        goto done;
+
+    while (*content != 0) {
+        len = 4;
+        codepoint = xmlGetUTF8Char(content, &len);
+        if (codepoint < 0) {
+            /* Let the backtracking matcher report the error */
+            ret = XML_REG_DFA_FALLBACK;
+            goto done;
+        }
+        content += len;
+
+        for (i = 0; i < next->nbActive; i++)
+            next->sets[next->active[i]].nbIntervals = 0;
+        next->nbActive = 0;
+
+        for (i = 0; i < cur->nbActive; i++) {
+            int config = cur->active[i];
+
+            set = &cur->sets[config];
+            if (config < comp->nbStates) {
+                xmlRegStatePtr state = comp->states[config];
+                const int *bases = &map->transBase[map->stateTrans[config]];
+
+                for (j = 0; j < state->nbTrans; j++) {
+                    int max = INT_MAX - 1, shift = 0;
+
+                    trans = &state->trans[j];
+                    if ((trans->to < 0) || (trans->atom == NULL))
+                        continue;
+                    ret = xmlRegCheckCharacter(trans->atom, codepoint);
+                    if (ret < 0) {
+                        ret = XML_REG_DFA_FALLBACK;
+                        goto done;
+                    }
+                    if (ret == 0)
+                        continue;
+                    /* The counter is incremented when entering an atom */
+                    if (trans->counter >= 0) {
+                        max = counter->max - 1;
+                        shift = 1;
+                    }
+                    if ((trans->atom->max == 0) || (trans->atom->min <= 1)) {
+                        ret = xmlRegCountAddSet(next, trans->to, set,
+                                                0, max, shift);
+                        if (ret < 0)
+                            goto done;
+                    }
+                    if (trans->atom->max > 1) {
+                        ret = xmlRegCountAddSet(next, bases[j], set,
+                                                0, max, shift);
+                        if (ret < 0)
+                            goto done;
+                    }
+                }
+            } else {
+                int count;
+
+                trans = map->configTrans[config - comp->nbStates];
+                count = map->configCount[config - comp->nbStates] + 1;
+                ret = xmlRegCheckCharacter(trans->atom, codepoint);
+                if (ret < 0) {
+                    ret = XML_REG_DFA_FALLBACK;
+                    goto done;
+                }
+                if (ret == 0)
+                    continue;
+                if (count >= trans->atom->min) {
+                    ret = xmlRegCountAddSet(next, trans->to, set,
+                                            0, INT_MAX - 1, 0);
+                    if (ret < 0)
+                        goto done;
+                }
+                if (count < trans->atom->max) {
+                    ret = xmlRegCountAddSet(next, config + 1, set,
+                                            0, INT_MAX - 1, 0);
+                    if (ret < 0)
+                        goto done;
+                }
+            }
+        }
+
+        if (next->nbActive == 0) {
+            ret = 0;
+            goto done;
+        }
+        ret = xmlRegCountClosure(comp, next);
+        if (ret < 0)
+            goto done;
+
+        tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+
+    ret = 0;
+    for (i = 0; i < cur->nbActive; i++) {
+        int config = cur->active[i];
+
+        if ((config < comp->nbStates) &&
+            (comp->states[config]->type == XML_REGEXP_FINAL_STATE)) {
+            ret = 1;
+            break;
+        }
+    }
+
+done:
+    for (i = 0; i < 2; i++) {
+        if (gens[i].sets != NULL) {
+            for (j = 0; j < nbConfigs; j++)
+                xmlFree(gens[i].sets[j].bounds);
+            xmlFree(gens[i].sets);
+        }
+        xmlFree(gens[i].active);
+    }
+    return(ret);
+}
+
+/**
+ * Check whether every path from the start to a final state of the
+ * automaton has to consume a character, that is, whether the final
+ * state is unreachable without the transitions matching only this
+ * character. Counters are ignored which only allows more paths.
+ *
+ * @param comp  the compiled regexp
+ * @param c  an ASCII character
+ * @param stack  scratch space of nbStates entries
+ * @param seen  scratch space of nbStates entries
+ * @returns 1 if the character is required, 0 otherwise.
+ */
+static int
+xmlRegIsRequired(xmlRegexpPtr comp, int c, int *stack, char *seen) {
+    xmlRegStatePtr state;
+    xmlRegTransPtr trans;
+    xmlRegAtomPtr atom;
+    int i, n = 0;
+
+    memset(seen, 0, comp->nbStates);
+    stack[n++] = 0;
+    seen[0] = 1;
+    while (n > 0) {
+        state = comp->states[stack[--n]];
+        if (state->type == XML_REGEXP_FINAL_STATE)
+            return(0);
+        for (i = 0; i < state->nbTrans; i++) {
+            trans = &state->trans[i];
+            if ((trans->to < 0) || (seen[trans->to]) ||
+                (comp->states[trans->to] == NULL))
+                continue;
+            atom = trans->atom;
+            if ((atom != NULL) && (atom->type == XML_REGEXP_CHARVAL) &&
+                (atom->codepoint == c) &&
+                ((atom->max == 0) || (atom->min >= 1)))
+                continue;
+            seen[trans->to] = 1;
+            stack[n++] = trans->to;
+        }
+    }
+
+    return(1);
+}
+
+/**
+ * Find an ASCII character which occurs in every matching string.
+ * Strings without it can be rejected with a fast scan before
+ * running the backtracking matcher. Punctuation is preferred since
+ * it tends to be rare in input which doesn't match.
+ *
+ * @param comp  the compiled regexp
+ */
+static void
+xmlRegComputeRequired(xmlRegexpPtr comp) {
+    int *stack;
+    char *seen;
+    int c, found = 0;
+
+    if ((comp->nbStates <= 0) || (comp->states == NULL) ||
+        (comp->states[0] == NULL))
+        return;
+
+    stack = xmlMalloc(comp->nbStates * sizeof(int));
+    seen = xmlMalloc(comp->nbStates);
+    if ((stack == NULL) || (seen == NULL))
+        goto done;
+
+    for (c = 0x21; c < 0x7F; c++) {
+        if (!xmlRegIsRequired(comp, c, stack, seen))
+            continue;
+        if ((found == 0) || (IS_ASCII_LETTER(found)) ||
+            (IS_ASCII_DIGIT(found))) {
+            found = c;
+            if ((!IS_ASCII_LETTER(c)) && (!IS_ASCII_DIGIT(c)))
+                break;
+        }
+    }
+    comp->required = found;
+
+done:
+    xmlFree(stack);
+    xmlFree(seen);
+}
+
+/************************************************************************
+ *									*
+ *	Progressive interface to the verifier one atom at a time	*
+ *									*
+ ************************************************************************/
+
+/**
+ * Build a context used for progressive evaluation of a regexp.
+ *
+ * @deprecated Internal function, don't use.
+ *
+ * @param comp  a precompiled regular expression
+ * @param callback  a callback function used for handling progresses in the
+ *            automata matching phase
+ * @param data  the context data associated to the callback in this context
+ * @returns the new context
+ */
+xmlRegExecCtxt *
+xmlRegNewExecCtxt(xmlRegexp *comp, xmlRegExecCallbacks callback, void *data) {
+    xmlRegExecCtxtPtr exec;
+
+    if (comp == NULL)
+	return(NULL);
+    if ((comp->compact == NULL) && (comp->states == NULL))
+        return(NULL);
+    exec = (xmlRegExecCtxtPtr) xmlMalloc(sizeof(xmlRegExecCtxt));
+    if (exec == NULL)
+	return(NULL);
+    memset(exec, 0, sizeof(xmlRegExecCtxt));
+    if (xmlRegExecReset(exec, comp, callback, data) < 0) {
+        xmlFree(exec);
+        return(NULL);
+    }
+    return(exec);
+}
+
+/**
+ * Reset a context for progressive evaluation of a regexp, so that it
+ * can be used for a new run, possibly with another regexp. This
+ * keeps the memory allocated for the rollback stack and the
+ * counters, which is cheaper than creating a new context with
+ * #xmlRegNewExecCtxt.
+ *
+ * @deprecated Internal function, don't use.
+ *
+ * @since 2.16.0
+ *
+ * @param exec  a regular expression evaluation context
+ * @param comp  a precompiled regular expression
+ * @param callback  a callback function used for handling progresses in the
+ *            automata matching phase
+ * @param data  the context data associated to the callback in this context
+ * @returns 0 on success or -1 if an argument is invalid or a memory
+ * allocation failed. The context is unchanged in case of error.
+ */
+int
+xmlRegExecReset(xmlRegExecCtxt *exec, xmlRegexp *comp,
+                xmlRegExecCallbacks callback, void *data) {
+    int i;
+
+    if ((exec == NULL) || (comp == NULL))
+        return(-1);
+    if ((comp->compact == NULL) && (comp->states == NULL))
+        return(-1);
+
+    if (comp->nbCounters > exec->maxCounters) {
+        int *counts;
+
+        /*
+	 * For error handling, exec->counts is allocated twice the size
+	 * the second half is used to store the data in case of rollback
+	 */
+	counts = (int *) xmlMalloc(comp->nbCounters * sizeof(int) * 2);
+	if (counts == NULL)
+	    return(-1);
+        xmlFree(exec->counts);
+        xmlFree(exec->spareCounts);
+        exec->counts = NULL;
+        exec->spareCounts = counts;
+        exec->maxCounters = comp->nbCounters;
+
+        /* The saved counters of rollbacks are too small now */
+        for (i = 0; i < exec->maxRollbacks; i++) {
+            xmlFree(exec->rollbacks[i].counts);
+            exec->rollbacks[i].counts = NULL;
+        }
+    }
+
+    /* counts must be NULL if the regexp has no counters */
+    if (exec->counts != NULL) {
+        exec->spareCounts = exec->counts;
+        exec->counts = NULL;
+    }
+    if (comp->nbCounters > 0) {
+        exec->counts = exec->spareCounts;
+        exec->spareCounts = NULL;
+        memset(exec->counts, 0, comp->nbCounters * sizeof(int) * 2);
+	exec->errCounts = &exec->counts[comp->nbCounters];
+    } else {
+	exec->errCounts = NULL;
+    }
+
+    /* A non-NULL input stack means that input is replayed */
+    if (exec->inputStack != NULL) {
+        for (i = 0; i < exec->inputStackNr; i++) {
+            if (exec->inputStack[i].value != NULL)
+                xmlFree(exec->inputStack[i].value);
+        }
+        xmlFree(exec->inputStack);
+        exec->inputStack = NULL;
+    }
+    exec->inputStackMax = 0;
+    exec->inputStackNr = 0;
+    if (exec->errString != NULL) {
+        xmlFree(exec->errString);
+        exec->errString = NULL;
+    }
+
+    exec->inputString = NULL;
+    exec->index = 0;
+    exec->determinist = 1;
+    exec->nbRollbacks = 0;
+    exec->status = XML_REGEXP_OK;
+    exec->comp = comp;
+    exec->state = (comp->compact == NULL) ? comp->states[0] : NULL;
+    exec->transno = 0;
+    exec->transcount = 0;
+    exec->callback = callback;
+    exec->data = data;
+    exec->errStateNo = -1;
+    exec->errState = NULL;
+    exec->nbPush = 0;
+    return(0);
+}
+
+/**
+ * Free the structures associated to a regular expression evaluation context.
+ *
+ * @deprecated Internal function, don't use.
+ *
+ * @param exec  a regular expression evaluation context
+ */
+void
+xmlRegFreeExecCtxt(xmlRegExecCtxt *exec) {
+    if (exec == NULL)
+	return;
+
+    if (exec->rollbacks != NULL) {
+        int i;
+
+        for (i = 0;i < exec->maxRollbacks;i++)
+            if (exec->rollbacks[i].counts != NULL)
+                xmlFree(exec->rollbacks[i].counts);
+	xmlFree(exec->rollbacks);
+    }
+    if (exec->counts != NULL)
+	xmlFree(exec->counts);
+    if (exec->spareCounts != NULL)
+	xmlFree(exec->spareCounts);
+    if (exec->inputStack != NULL) {
+	int i;
+
+	for (i = 0;i < exec->inputStackNr;i++) {
+	    if (exec->inputStack[i].value != NULL)
+		xmlFree(exec->inputStack[i].value);
+	}
+	xmlFree(exec->inputStack);
+    }
+    if (exec->errString != NULL)
+        xmlFree(exec->errString);
+    xmlFree(exec);
+}
+
+/**
+ * Create a pool of regexp execution contexts. Validators use a pool
+ * to avoid allocating a context for every element.
+ *
+ * @returns the pool or NULL if a memory allocation failed.
+ */
+xmlRegExecPool *
+xmlRegExecPoolCreate(void) {
+    xmlRegExecPoolPtr pool;
+
+    pool = xmlMalloc(sizeof(*pool));
+    if (pool == NULL)
+        return(NULL);
+    pool->nb = 0;
+    return(pool);
+}
+
+/**
+ * Free a pool and the contexts it holds.
+ *
+ * @param pool  the pool (optional)
+ */
+void
+xmlRegExecPoolFree(xmlRegExecPool *pool) {
+    if (pool == NULL)
+        return;
+    while (pool->nb > 0)
+        xmlRegFreeExecCtxt(pool->tab[--pool->nb]);
+    xmlFree(pool);
+}
+
+/**
+ * Get an execution context for `comp` from a pool, or create a new
+ * one if the pool is empty.
+ *
+ * @param pool  the pool (optional)
+ * @param comp  a precompiled regular expression
+ * @param callback  progress callback
+ * @param data  the context data passed to the callback
+ * @returns the context or NULL if a memory allocation failed.
+ */
+xmlRegExecCtxt *
+xmlRegExecPoolGet(xmlRegExecPool *pool, xmlRegexp *comp,
+                  xmlRegExecCallbacks callback, void *data) {
+    if ((pool != NULL) && (pool->nb > 0)) {
+        xmlRegExecCtxtPtr exec = pool->tab[pool->nb - 1];
+
+        if (xmlRegExecReset(exec, comp, callback, data) == 0) {
+            pool->nb--;
+            return(exec);
+        }
+    }
+
+    return(xmlRegNewExecCtxt(comp, callback, data));
+}
+
+/**
+ * Return an execution context to a pool. The context is freed if
+ * the pool is full or NULL.
+ *
+ * @param pool  the pool (optional)
+ * @param exec  the context (optional)
+ */
+void
+xmlRegExecPoolPut(xmlRegExecPool *pool, xmlRegExecCtxt *exec) {
+    if (exec == NULL)
+        return;
+    if ((pool == NULL) || (pool->nb >= XML_REG_EXEC_POOL_MAX)) {
+        xmlRegFreeExecCtxt(exec);
+        return;
+    }
+    pool->tab[pool->nb++] = exec;
+}
+
+static int
+xmlRegExecSetErrString(xmlRegExecCtxtPtr exec, const xmlChar *value) {
+    if (exec->errString != NULL)
+        xmlFree(exec->errString);
+    if (value == NULL) {
+        exec->errString = NULL;
+    } else {
+        exec->errString = xmlStrdup(value);
+        if (exec->errString == NULL) {
+            exec->status = XML_REGEXP_OUT_OF_MEMORY;
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+static void
+xmlFARegExecSaveInputString(xmlRegExecCtxtPtr exec, const xmlChar *value,
+	                    void *data) {
+    if (exec->inputStackNr + 1 >= exec->inputStackMax) {
+	xmlRegInputTokenPtr tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(exec->inputStackMax, sizeof(tmp[0]),
+                                  4, XML_MAX_ITEMS);
+	if (newSize < 0) {
+            exec->status = XML_REGEXP_OUT_OF_MEMORY;
+	    return;
+	}
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+        if (newSize < 2)
+            newSize = 2;
+#endif
+	tmp = xmlRealloc(exec->inputStack, newSize * sizeof(tmp[0]));
+	if (tmp == NULL) {
+            exec->status = XML_REGEXP_OUT_OF_MEMORY;
+	    return;
+	}
+	exec->inputStack = tmp;
+	exec->inputStackMax = newSize;
+    }
+    if (value == NULL) {
+        exec->inputStack[exec->inputStackNr].value = NULL;
+    } else {
+        exec->inputStack[exec->inputStackNr].value = xmlStrdup(value);
+        if (exec->inputStack[exec->inputStackNr].value == NULL) {
+            exec->status = XML_REGEXP_OUT_OF_MEMORY;
+            return;
+        }
+    }
+    exec->inputStack[exec->inputStackNr].data = data;
+    exec->inputStackNr++;
+    exec->inputStack[exec->inputStackNr].value = NULL;
+    exec->inputStack[exec->inputStackNr].data = NULL;
+}
+
+/**
+ * Checks if both strings are equal or have the same content. "*"
+ * can be used as a wildcard in `valStr`; "|" is used as a separator of
+ * substrings in both `expStr` and `valStr`.
+ *
+ * @param expStr  the string to be evaluated
+ * @param valStr  the validation string
+ * @returns 1 if the comparison is satisfied and the number of substrings
+ * is equal, 0 otherwise.
+ */
+
+static int
+xmlRegStrEqualWildcard(const xmlChar *expStr, const xmlChar *valStr) {
+    if (expStr == valStr) return(1);
+    if (expStr == NULL) return(0);
+    if (valStr == NULL) return(0);
+    do {
+	/*
+	* Eval if we have a wildcard for the current item.
+	*/
+        if (*expStr != *valStr) {
+	    /* if one of them starts with a wildcard make valStr be it */
+	    if (*valStr == '*') {
+	        const xmlChar *tmp;
+
+		tmp = valStr;
+		valStr = expStr;
+		expStr = tmp;
+	    }
+	    if ((*valStr != 0) && (*expStr != 0) && (*expStr++ == '*')) {
+		do {
+		    if (*valStr == XML_REG_STRING_SEPARATOR)
+			break;
+		    valStr++;
+		} while (*valStr != 0);
+		continue;
+	    } else
+		return(0);
+	}
+	expStr++;
+	valStr++;
+    } while (*valStr != 0);
+    if (*expStr != 0)
+	return (0);
+    else
+	return (1);
+}
+
+/**
+ * Follow the transition of string `i` from the current state of a
+ * compact automaton.
+ *
+ * @param exec  a regexp execution context
+ * @param comp  the precompiled exec with a compact table
+ * @param i  the index of the string in the string map
+ * @param value  the token for error reports
+ * @param data  data associated to the token to reuse in callbacks
+ * @returns 1 if the regexp reached a final state, 0 if non-final, and
+ *     a negative value in case of error.
+ */
+static int
+xmlRegCompactStep(xmlRegExecCtxtPtr exec, xmlRegexpPtr comp, int i,
+                  const xmlChar *value, void *data) {
+    int state = exec->index;
+    int stride = comp->nbstrings + 1;
+    int target;
+
+    target = comp->compact[state * stride + i + 1];
+    if ((target <= 0) || (target > comp->nbstates))
+        goto error;
+    target--; /* to avoid 0 */
+    exec->index = target;
+    if ((exec->callback != NULL) && (comp->transdata != NULL)) {
+        exec->callback(exec->data, value,
+                       comp->transdata[state * comp->nbstrings + i], data);
+    }
+    if (comp->compact[target * stride] == XML_REGEXP_SINK_STATE)
+        goto error;
+    if (comp->compact[target * stride] == XML_REGEXP_FINAL_STATE)
+        return(1);
+    return(0);
+
+error:
+    exec->errStateNo = state;
+    exec->status = XML_REGEXP_NOT_FOUND;
+    xmlRegExecSetErrString(exec, value);
+    return(exec->status);
 }
 
 /**
@@ -3838,29 +5236,14 @@ xmlRegCompactPushString(xmlRegExecCtxtPtr exec,
     for (i = 0;i < comp->nbstrings;i++) {
 	target = comp->compact[state * (comp->nbstrings + 1) + i + 1];
 	if ((target > 0) && (target <= comp->nbstates)) {
-	    target--; /* to avoid 0 */
-	    if (xmlRegStrEqualWildcard(comp->stringMap[i], value)) {
-		exec->index = target;
-		if ((exec->callback != NULL) && (comp->transdata != NULL)) {
-		    exec->callback(exec->data, value,
-			  comp->transdata[state * comp->nbstrings + i], data);
-		}
-		if (comp->compact[target * (comp->nbstrings + 1)] ==
-		    XML_REGEXP_SINK_STATE)
-		    goto error;
-
-		if (comp->compact[target * (comp->nbstrings + 1)] ==
-		    XML_REGEXP_FINAL_STATE)
-		    return(1);
-		return(0);
-	    }
+	    if (xmlRegStrEqualWildcard(comp->stringMap[i], value))
+		return(xmlRegCompactStep(exec, comp, i, value, data));
 	}
     }
     /*
      * Failed to find an exit transition out from current state for the
      * current token
      */
-error:
     exec->errStateNo = state;
     exec->status = XML_REGEXP_NOT_FOUND;
     xmlRegExecSetErrString(exec, value);
@@ -4250,6 +5633,51 @@ xmlRegExecPushString2(xmlRegExecCtxt *exec, const xmlChar *value,
     return(ret);
 }
 
+/**
+ * Push a possibly qualified name in the execution context. If the
+ * regexp has a name table, the transition is found by pointer for
+ * names interned in the dictionary of the table, or by `hashValue`
+ * without comparing the name against every string of the automaton.
+ * Otherwise, this works like #xmlRegExecPushString2.
+ *
+ * @param exec  a regexp execution context
+ * @param name  the local name
+ * @param ns  the namespace name (optional)
+ * @param hashValue  the hash of the name from #xmlRegExecHashName or 0
+ *     to compute it if needed
+ * @param data  data associated to the token to reuse in callbacks
+ * @returns 1 if the regexp reached a final state, 0 if non-final, and
+ *     a negative value in case of error.
+ */
+int
+xmlRegExecPushName(xmlRegExecCtxt *exec, const xmlChar *name,
+                   const xmlChar *ns, unsigned hashValue, void *data) {
+    xmlRegexpPtr comp;
+    int i;
+
+    if ((exec == NULL) || (exec->comp == NULL) || (name == NULL))
+	return(-1);
+    if (exec->status != XML_REGEXP_OK)
+	return(exec->status);
+
+    comp = exec->comp;
+    if ((comp->names != NULL) && (comp->compact != NULL)) {
+        if (hashValue == 0)
+            hashValue = xmlRegExecHashName(name, ns);
+        i = xmlRegNameTableFind(comp, exec->index, name, ns, hashValue);
+        if (i >= 0) {
+            /* Wildcards pass the local name to the callback */
+            return(xmlRegCompactStep(exec, comp, i,
+                                     comp->stringMap[i][0] == '*' ?
+                                         name : comp->stringMap[i],
+                                     data));
+        }
+        /* Report errors like the string variant */
+    }
+
+    return(xmlRegExecPushString2(exec, name, ns, data));
+}
+
 /**
  * Extract information from the regexp execution. Internal routine to
  * implement #xmlRegExecNextValues and #xmlRegExecErrInfo
@@ -5424,24 +6852,141 @@ xmlRegexpPrint(FILE *output ATTRIBUTE_UNUSED,
                xmlRegexp *regexp ATTRIBUTE_UNUSED) {
 }
 
+/************************************************************************
+ *									*
+ *	Cache of compiled regexps shared by all threads			*
+ *									*
+ ************************************************************************/
+
+static xmlMutex xmlRegCacheMutex;
+static xmlHashTablePtr xmlRegCache;
+/* Seed of the name table hashes */
+static unsigned xmlRegNameSeed;
+
 /**
- * Parses an XML Schemas regular expression.
+ * Initialize the regexp cache.
+ */
+void
+xmlInitRegexpCacheInternal(void) {
+    xmlInitMutex(&xmlRegCacheMutex);
+    xmlRegNameSeed = xmlGlobalRandom();
+}
+
+/**
+ * Free the regexp cache. Regexps still in use are owned by their
+ * users.
+ */
+void
+xmlCleanupRegexpCacheInternal(void) {
+    xmlHashFree(xmlRegCache, NULL);
+    xmlRegCache = NULL;
+    xmlCleanupMutex(&xmlRegCacheMutex);
+}
+
+/**
+ * Look up a regexp in the cache and take a reference.
  *
- * Parses a regular expression conforming to XML Schemas Part 2 Datatype
- * Appendix F and builds an automata suitable for testing strings against
- * that regular expression.
+ * @param regexp  the regular expression string
+ * @returns the shared regexp or NULL if it isn't cached.
+ */
+static xmlRegexpPtr
+xmlRegCacheLookup(const xmlChar *regexp) {
+    xmlRegexpPtr ret;
+
+    xmlMutexLock(&xmlRegCacheMutex);
+    ret = xmlHashLookup(xmlRegCache, regexp);
+    if (ret != NULL)
+        ret->refCount++;
+    xmlMutexUnlock(&xmlRegCacheMutex);
+
+    return(ret);
+}
+
+/**
+ * Add a freshly compiled regexp to the cache. If another thread
+ * compiled the same expression in the meantime, the new regexp is
+ * freed and the cached one returned.
+ *
+ * @param comp  the compiled regexp
+ * @returns the regexp to use.
+ */
+static xmlRegexpPtr
+xmlRegCacheAdd(xmlRegexpPtr comp) {
+    xmlRegexpPtr ret;
+    xmlMemBudget *budget;
+
+    /*
+     * Shared regexps must not be modified, so compute the
+     * determinism now instead of lazily.
+     */
+    xmlRegexpIsDeterminist(comp);
+
+    xmlMutexLock(&xmlRegCacheMutex);
+
+    ret = xmlHashLookup(xmlRegCache, comp->string);
+    if (ret != NULL) {
+        ret->refCount++;
+        xmlMutexUnlock(&xmlRegCacheMutex);
+        xmlRegFreeRegexp(comp);
+        return(ret);
+    }
+
+    /* The cache outlives the budget of the current caller. */
+    budget = xmlMemBudgetSuspend();
+    if (xmlRegCache == NULL)
+        xmlRegCache = xmlHashCreate(0);
+    /* Optional, so ignore malloc failures */
+    if ((xmlRegCache != NULL) &&
+        (xmlHashAddEntry(xmlRegCache, comp->string, comp) == 0)) {
+        comp->cached = 1;
+        comp->refCount = 1;
+    }
+    xmlMemBudgetLeave(budget);
+
+    xmlMutexUnlock(&xmlRegCacheMutex);
+
+    return(comp);
+}
+
+/**
+ * Drop a reference to a cached regexp.
+ *
+ * @param comp  the compiled regexp
+ * @returns 1 if the regexp must be freed, 0 if it's still in use.
+ */
+static int
+xmlRegCacheRelease(xmlRegexpPtr comp) {
+    xmlMemBudget *budget;
+    int ret = 0;
+
+    xmlMutexLock(&xmlRegCacheMutex);
+    comp->refCount--;
+    if (comp->refCount <= 0) {
+        budget = xmlMemBudgetSuspend();
+        xmlHashRemoveEntry(xmlRegCache, comp->string, NULL);
+        if (xmlHashSize(xmlRegCache) == 0) {
+            xmlHashFree(xmlRegCache, NULL);
+            xmlRegCache = NULL;
+        }
+        xmlMemBudgetLeave(budget);
+        ret = 1;
+    }
+    xmlMutexUnlock(&xmlRegCacheMutex);
+
+    return(ret);
+}
+
+/**
+ * Compile a regular expression without looking at the cache.
  *
  * @param regexp  a regular expression string
  * @returns the compiled expression or NULL in case of error
  */
-xmlRegexp *
-xmlRegexpCompile(const xmlChar *regexp) {
+static xmlRegexpPtr
+xmlRegexpCompileInternal(const xmlChar *regexp) {
     xmlRegexpPtr ret = NULL;
     xmlRegParserCtxtPtr ctxt;
 
-    if (regexp == NULL)
-        return(NULL);
-
     ctxt = xmlRegNewParserCtxt(regexp);
     if (ctxt == NULL)
 	return(NULL);
@@ -5471,12 +7016,53 @@ xmlRegexpCompile(const xmlChar *regexp) {
     if (ctxt->error != 0)
         goto error;
     ret = xmlRegEpxFromParse(ctxt);
+    /* Optional, so ignore malloc failures */
+    if (ret != NULL) {
+        ret->dfa = xmlRegDfaNew(ret);
+        if (ret->dfa == NULL)
+            ret->countMap = xmlRegCountNew(ret);
+        xmlRegComputeRequired(ret);
+    }
 
 error:
     xmlRegFreeParserCtxt(ctxt);
     return(ret);
 }
 
+/**
+ * Parses an XML Schemas regular expression.
+ *
+ * Parses a regular expression conforming to XML Schemas Part 2 Datatype
+ * Appendix F and builds an automata suitable for testing strings against
+ * that regular expression.
+ *
+ * Since 2.16.0, compiled expressions are cached and shared between
+ * callers compiling the same string, for example the patterns of
+ * several schemas. A shared expression is freed when the last user
+ * calls #xmlRegFreeRegexp.
+ *
+ * @param regexp  a regular expression string
+ * @returns the compiled expression or NULL in case of error
+ */
+xmlRegexp *
+xmlRegexpCompile(const xmlChar *regexp) {
+    xmlRegexpPtr ret;
+
+    if (regexp == NULL)
+        return(NULL);
+
+    xmlInitParser();
+
+    ret = xmlRegCacheLookup(regexp);
+    if (ret != NULL)
+        return(ret);
+
+    ret = xmlRegexpCompileInternal(regexp);
+    if (ret == NULL)
+        return(NULL);
+    return(xmlRegCacheAdd(ret));
+}
+
 /**
  * Check if the regular expression matches a string.
  *
@@ -5488,6 +7074,25 @@ int
 xmlRegexpExec(xmlRegexp *comp, const xmlChar *content) {
     if ((comp == NULL) || (content == NULL))
 	return(-1);
+    if (comp->dfa != NULL) {
+        int ret = xmlRegDfaExec(comp, content);
+
+        if (ret != XML_REG_DFA_FALLBACK)
+            return(ret);
+    }
+    /*
+     * The DFA already rejects a string at its first unexpected byte,
+     * so the prefilter only runs before the other matchers.
+     */
+    if ((comp->required != 0) &&
+        (strchr((const char *) content, comp->required) == NULL))
+        return(0);
+    if (comp->countMap != NULL) {
+        int ret = xmlRegCountExec(comp, content);
+
+        if (ret != XML_REG_DFA_FALLBACK)
+            return(ret);
+    }
     return(xmlFARegExec(comp, content));
 }
 
@@ -5551,6 +7156,9 @@ xmlRegFreeRegexp(xmlRegexp *regexp) {
     if (regexp == NULL)
 	return;
 
+    if ((regexp->cached) && (!xmlRegCacheRelease(regexp)))
+        return;
+
     if (regexp->string != NULL)
 	xmlFree(regexp->string);
     if (regexp->states != NULL) {
@@ -5574,10 +7182,728 @@ xmlRegFreeRegexp(xmlRegexp *regexp) {
 	    xmlFree(regexp->stringMap[i]);
 	xmlFree(regexp->stringMap);
     }
+    xmlRegDfaFree(regexp->dfa);
+    xmlRegCountFree(regexp->countMap);
+    xmlRegNameTableFree(regexp->names);
 
     xmlFree(regexp);
 }
 
+/************************************************************************
+ *									*
+ *			Name tables					*
+ *									*
+ ************************************************************************/
+
+/*
+ * Index of the strings of a compact automaton. Names interned in the
+ * same dictionary map to a column of the transition table by pointer,
+ * other names through a hash of their content computed by the caller
+ * with #xmlRegExecHashName. Qualified names are split at the separator.
+ *
+ * Namespace wildcards "*|ns" are indexed like names with the local
+ * name "*", "*|*" and "*" are kept apart.
+ */
+struct _xmlRegNameTable {
+    xmlDictPtr dict;
+    const xmlChar **names;
+    const xmlChar **nsNames;
+    int *buckets;       /* string index + 1, 0 for empty slots */
+    unsigned *hashes;
+    int *hashBuckets;   /* same by content hash */
+    int bits;
+    const xmlChar *star; /* "*" in the dictionary */
+    int nsWildcards;    /* has "*|ns" strings */
+    int anyNs;          /* index of "*|*" or -1 */
+    int noNs;           /* index of "*" or -1 */
+};
+
+static void
+xmlRegNameTableFree(xmlRegNameTable *table) {
+    if (table == NULL)
+        return;
+    xmlFree(table->names);
+    xmlFree(table->nsNames);
+    xmlFree(table->buckets);
+    xmlFree(table->hashes);
+    xmlFree(table->hashBuckets);
+    xmlDictFree(table->dict);
+    xmlFree(table);
+}
+
+static unsigned
+xmlRegNameHash(const xmlChar *name, const xmlChar *ns, int bits) {
+    unsigned v = (unsigned) ((size_t) name >> 3) ^
+                 (unsigned) ((size_t) ns >> 1);
+
+    return((v * 2654435761u) >> (32 - bits));
+}
+
+/**
+ * Hash a name the way the strings of name tables are hashed, for use
+ * with #xmlRegExecPushName. The value doesn't depend on the regexp and
+ * can be computed once per name.
+ *
+ * @param name  the local name
+ * @param ns  the namespace name (optional)
+ * @returns the hash value.
+ */
+unsigned
+xmlRegExecHashName(const xmlChar *name, const xmlChar *ns) {
+    xmlHashState st;
+
+    xmlHashInit(&st, xmlRegNameSeed);
+    xmlHashUpdateString(&st, name, SIZE_MAX);
+    if (ns != NULL) {
+        xmlHashUpdateByte(&st, XML_REG_STRING_SEPARATOR);
+        xmlHashUpdateString(&st, ns, SIZE_MAX);
+    }
+    return(xmlHashFinish(&st));
+}
+
+/**
+ * Resolve the strings of a deterministic automaton to names
+ * interned in `dict`, allowing to walk the compact transition
+ * table with #xmlRegexpNameStep instead of an execution context,
+ * and to push names with #xmlRegExecPushName.
+ *
+ * Only automata with a compact form and plain string transitions,
+ * like DTD and schema content models, are supported. Strings may be
+ * qualified names. The only wildcards allowed are a local name "*"
+ * and a namespace "*".
+ *
+ * @param regexp  a compiled regexp
+ * @param dict  the dictionary of the names to match (optional)
+ * @returns 0 on success, 1 if the automaton isn't supported and
+ * -1 if a memory allocation failed.
+ */
+int
+xmlRegexpBuildNameTable(xmlRegexp *regexp, xmlDict *dict) {
+    xmlRegNameTable *table;
+    int i, size;
+
+    if ((regexp == NULL) || (regexp->compact == NULL) ||
+        (regexp->stringMap == NULL))
+        return(1);
+    if (regexp->names != NULL)
+        return(0);
+
+    for (i = 0; i < regexp->nbstrings; i++) {
+        const xmlChar *str = regexp->stringMap[i];
+        const xmlChar *star = xmlStrchr(str, '*');
+
+        if (star == NULL)
+            continue;
+        /* "*", "*|*" or "*|ns" */
+        if ((star != str) ||
+            ((str[1] != 0) &&
+             ((str[1] != XML_REG_STRING_SEPARATOR) ||
+              ((xmlStrchr(str + 2, '*') != NULL) &&
+               (!xmlStrEqual(str + 2, BAD_CAST "*"))))))
+            return(1);
+    }
+
+    table = xmlMalloc(sizeof(*table));
+    if (table == NULL)
+        return(-1);
+    memset(table, 0, sizeof(*table));
+    table->anyNs = -1;
+    table->noNs = -1;
+    if (regexp->nbstrings == 0)
+        goto done;
+
+    for (i = 0; i < regexp->nbstrings; i++) {
+        const xmlChar *str = regexp->stringMap[i];
+
+        if (str[0] != '*')
+            continue;
+        if (str[1] == 0)
+            table->noNs = i;
+        else if (xmlStrEqual(str + 2, BAD_CAST "*"))
+            table->anyNs = i;
+        else
+            table->nsWildcards = 1;
+    }
+
+    table->bits = 1;
+    while ((1 << table->bits) < 2 * regexp->nbstrings)
+        table->bits++;
+    size = 1 << table->bits;
+
+    table->hashes = xmlMalloc(regexp->nbstrings * sizeof(table->hashes[0]));
+    table->hashBuckets = xmlMalloc(size * sizeof(table->hashBuckets[0]));
+    if ((table->hashes == NULL) || (table->hashBuckets == NULL))
+        goto error;
+    memset(table->hashBuckets, 0, size * sizeof(table->hashBuckets[0]));
+
+    for (i = 0; i < regexp->nbstrings; i++) {
+        xmlHashState st;
+        unsigned h;
+
+        /* The same as hashing the name and namespace separately */
+        xmlHashInit(&st, xmlRegNameSeed);
+        xmlHashUpdateString(&st, regexp->stringMap[i], SIZE_MAX);
+        table->hashes[i] = xmlHashFinish(&st);
+
+        h = table->hashes[i] & (size - 1);
+        while (table->hashBuckets[h] != 0)
+            h = (h + 1) & (size - 1);
+        table->hashBuckets[h] = i + 1;
+    }
+
+    if (dict != NULL) {
+        table->dict = dict;
+        xmlDictReference(dict);
+        table->star = xmlDictLookup(dict, BAD_CAST "*", 1);
+        if (table->star == NULL)
+            goto error;
+        table->names = xmlMalloc(regexp->nbstrings * sizeof(table->names[0]));
+        table->nsNames = xmlMalloc(regexp->nbstrings *
+                                   sizeof(table->nsNames[0]));
+        table->buckets = xmlMalloc(size * sizeof(table->buckets[0]));
+        if ((table->names == NULL) || (table->nsNames == NULL) ||
+            (table->buckets == NULL))
+            goto error;
+        memset(table->buckets, 0, size * sizeof(table->buckets[0]));
+
+        for (i = 0; i < regexp->nbstrings; i++) {
+            const xmlChar *str = regexp->stringMap[i];
+            const xmlChar *sep = xmlStrchr(str, XML_REG_STRING_SEPARATOR);
+            const xmlChar *name, *ns = NULL;
+            unsigned h;
+
+            if (sep != NULL) {
+                name = xmlDictLookup(dict, str, sep - str);
+                ns = xmlDictLookup(dict, sep + 1, -1);
+                if (ns == NULL)
+                    goto error;
+            } else {
+                name = xmlDictLookup(dict, str, -1);
+            }
+            if (name == NULL)
+                goto error;
+            table->names[i] = name;
+            table->nsNames[i] = ns;
+
+            h = xmlRegNameHash(name, ns, table->bits);
+            while (table->buckets[h] != 0)
+                h = (h + 1) & (size - 1);
+            table->buckets[h] = i + 1;
+        }
+    }
+
+done:
+    regexp->names = table;
+    return(0);
+
+error:
+    xmlRegNameTableFree(table);
+    return(-1);
+}
+
+/*
+ * Find the column of a name in the compact transition table, first
+ * by pointer, then by content. Returns -1 if not found.
+ */
+static int
+xmlRegNameTableLookup(xmlRegexpPtr regexp, const xmlChar *name,
+                      const xmlChar *ns, unsigned hashValue) {
+    xmlRegNameTable *table = regexp->names;
+    unsigned mask = (1u << table->bits) - 1;
+    unsigned h;
+    int idx;
+
+    if (table->buckets != NULL) {
+        h = xmlRegNameHash(name, ns, table->bits);
+        while ((idx = table->buckets[h]) != 0) {
+            if ((table->names[idx - 1] == name) &&
+                (table->nsNames[idx - 1] == ns))
+                return(idx - 1);
+            h = (h + 1) & mask;
+        }
+    }
+
+    if (table->hashBuckets != NULL) {
+        const xmlChar *str, *cur;
+
+        h = hashValue & mask;
+        while ((idx = table->hashBuckets[h]) != 0) {
+            if (table->hashes[idx - 1] == hashValue) {
+                str = regexp->stringMap[idx - 1];
+                if (ns == NULL) {
+                    if (xmlStrEqual(str, name))
+                        return(idx - 1);
+                } else {
+                    cur = name;
+                    while ((*cur != 0) && (*str == *cur)) {
+                        str++;
+                        cur++;
+                    }
+                    if ((*cur == 0) &&
+                        (*str == XML_REG_STRING_SEPARATOR) &&
+                        (xmlStrEqual(str + 1, ns)))
+                        return(idx - 1);
+                }
+            }
+            h = (h + 1) & mask;
+        }
+    }
+
+    return(-1);
+}
+
+/*
+ * Find the column of the transition from `state` matching a name,
+ * including wildcards. If several match, the first one is used like
+ * in xmlRegCompactPushString. Returns -1 if there is none.
+ */
+static int
+xmlRegNameTableFind(xmlRegexpPtr regexp, int state, const xmlChar *name,
+                    const xmlChar *ns, unsigned hashValue) {
+    xmlRegNameTable *table = regexp->names;
+    const int *row = &regexp->compact[state * (regexp->nbstrings + 1) + 1];
+    int ret = -1;
+    int i;
+
+    i = xmlRegNameTableLookup(regexp, name, ns, hashValue);
+    if ((i >= 0) && (row[i] > 0))
+        ret = i;
+
+    if (ns == NULL) {
+        i = table->noNs;
+        if ((i >= 0) && (row[i] > 0) && ((ret < 0) || (i < ret)))
+            ret = i;
+        return(ret);
+    }
+
+    i = table->anyNs;
+    if ((i >= 0) && (row[i] > 0) && ((ret < 0) || (i < ret)))
+        ret = i;
+    if (table->nsWildcards) {
+        const xmlChar *star = table->star ? table->star : BAD_CAST "*";
+
+        i = xmlRegNameTableLookup(regexp, star, ns,
+                                  xmlRegExecHashName(BAD_CAST "*", ns));
+        if ((i >= 0) && (row[i] > 0) && ((ret < 0) || (i < ret)))
+            ret = i;
+    }
+
+    return(ret);
+}
+
+/**
+ * @param regexp  a compiled regexp
+ * @returns 1 if a name table was built for the regexp, 0 otherwise.
+ */
+int
+xmlRegexpHasNameTable(xmlRegexp *regexp) {
+    return((regexp != NULL) && (regexp->names != NULL));
+}
+
+/**
+ * Follow the transition for `name` from `state` in the compact
+ * table. The initial state is 0.
+ *
+ * @param regexp  a regexp with a name table
+ * @param state  the current state
+ * @param name  the name to match
+ * @returns the next state or -1 if the name isn't accepted.
+ */
+int
+xmlRegexpNameStep(xmlRegexp *regexp, int state, const xmlChar *name) {
+    xmlRegNameTable *table = regexp->names;
+    int stride = regexp->nbstrings + 1;
+    int i = -1;
+    int target;
+
+    if (table->buckets != NULL) {
+        unsigned mask = (1u << table->bits) - 1;
+        unsigned h = xmlRegNameHash(name, NULL, table->bits);
+        int idx;
+
+        while ((idx = table->buckets[h]) != 0) {
+            if ((table->names[idx - 1] == name) &&
+                (table->nsNames[idx - 1] == NULL)) {
+                i = idx - 1;
+                break;
+            }
+            h = (h + 1) & mask;
+        }
+    }
+
+    if (i < 0) {
+        /* Names from another dictionary or built on the fly */
+        for (i = 0; i < regexp->nbstrings; i++) {
+            if (xmlStrEqual(regexp->stringMap[i], name))
+                break;
+        }
+        if (i >= regexp->nbstrings)
+            return(-1);
+    }
+
+    target = regexp->compact[state * stride + i + 1];
+    if ((target <= 0) || (target > regexp->nbstates))
+        return(-1);
+    target--;
+    if (regexp->compact[target * stride] == XML_REGEXP_SINK_STATE)
+        return(-1);
+
+    return(target);
+}
+
+/**
+ * @param regexp  a regexp with a name table
+ * @param state  a state returned by #xmlRegexpNameStep or 0
+ * @returns 1 if `state` is final, 0 otherwise.
+ */
+int
+xmlRegexpIsFinalState(xmlRegexp *regexp, int state) {
+    return(regexp->compact[state * (regexp->nbstrings + 1)] ==
+           XML_REGEXP_FINAL_STATE);
+}
+
+/************************************************************************
+ *									*
+ *			Binary serialization				*
+ *									*
+ ************************************************************************/
+
+static void
+xmlRegSaveData(xmlBuf *buf, void *data,
+               xmlRegSaveDataFunc saveData, void *ctxt) {
+    if (saveData != NULL)
+        saveData(ctxt, buf, data);
+}
+
+static void *
+xmlRegLoadData(xmlBinReader *reader,
+               xmlRegLoadDataFunc loadData, void *ctxt) {
+    if (loadData == NULL)
+        return(NULL);
+    return(loadData(ctxt, reader));
+}
+
+/**
+ * Writes a compiled regexp in binary form. The lazily built
+ * matchers are not saved, only whether they exist.
+ *
+ * @param regexp  the compiled regexp
+ * @param buf  the output buffer
+ * @param saveData  callback writing transition data, may be NULL if
+ * the regexp has none
+ * @param ctxt  user data of the callback
+ */
+void
+xmlRegexpSave(xmlRegexp *regexp, xmlBuf *buf,
+              xmlRegSaveDataFunc saveData, void *ctxt) {
+    int i, j, n;
+
+    xmlBinWriteString(buf, regexp->string);
+    xmlBinWriteInt(buf, regexp->determinist);
+    xmlBinWriteInt(buf, regexp->flags);
+
+    xmlBinWriteInt(buf, regexp->nbCounters);
+    for (i = 0; i < regexp->nbCounters; i++) {
+        xmlBinWriteInt(buf, regexp->counters[i].min);
+        xmlBinWriteInt(buf, regexp->counters[i].max);
+    }
+
+    xmlBinWriteInt(buf, regexp->nbAtoms);
+    for (i = 0; i < regexp->nbAtoms; i++) {
+        xmlRegAtomPtr atom = regexp->atoms[i];
+
+        xmlBinWriteInt(buf, atom->type);
+        xmlBinWriteInt(buf, atom->quant);
+        xmlBinWriteInt(buf, atom->min);
+        xmlBinWriteInt(buf, atom->max);
+        if ((atom->type == XML_REGEXP_STRING) ||
+            (atom->type == XML_REGEXP_BLOCK_NAME))
+            xmlBinWriteString(buf, atom->valuep);
+        if (atom->type == XML_REGEXP_STRING)
+            xmlBinWriteString(buf, atom->valuep2);
+        xmlBinWriteInt(buf, atom->neg);
+        xmlBinWriteInt(buf, atom->codepoint);
+        xmlBinWriteInt(buf, atom->nbRanges);
+        for (j = 0; j < atom->nbRanges; j++) {
+            xmlRegRangePtr range = atom->ranges[j];
+
+            xmlBinWriteInt(buf, range->neg);
+            xmlBinWriteInt(buf, range->type);
+            xmlBinWriteInt(buf, range->start);
+            xmlBinWriteInt(buf, range->end);
+            xmlBinWriteString(buf, range->blockName);
+        }
+        xmlRegSaveData(buf, atom->data, saveData, ctxt);
+    }
+
+    xmlBinWriteInt(buf, regexp->nbStates);
+    for (i = 0; i < regexp->nbStates; i++) {
+        xmlRegStatePtr state = regexp->states[i];
+
+        if (state == NULL) {
+            xmlBinWriteInt(buf, -1);
+            continue;
+        }
+        xmlBinWriteInt(buf, state->type);
+        xmlBinWriteInt(buf, state->nbTrans);
+        for (j = 0; j < state->nbTrans; j++) {
+            xmlRegTransPtr trans = &state->trans[j];
+
+            xmlBinWriteInt(buf, trans->atom ? trans->atom->no : -1);
+            xmlBinWriteInt(buf, trans->to);
+            xmlBinWriteInt(buf, trans->counter);
+            xmlBinWriteInt(buf, trans->count);
+            xmlBinWriteInt(buf, trans->nd);
+        }
+    }
+
+    if (regexp->compact == NULL) {
+        xmlBinWriteInt(buf, -1);
+    } else {
+        xmlBinWriteInt(buf, regexp->nbstates);
+        xmlBinWriteInt(buf, regexp->nbstrings);
+        n = (regexp->nbstates + 1) * (regexp->nbstrings + 1);
+        for (i = 0; i < n; i++)
+            xmlBinWriteInt(buf, regexp->compact[i]);
+        for (i = 0; i < regexp->nbstrings; i++)
+            xmlBinWriteString(buf, regexp->stringMap[i]);
+        xmlBinWriteInt(buf, regexp->transdata != NULL);
+        if (regexp->transdata != NULL) {
+            n = regexp->nbstates * regexp->nbstrings;
+            for (i = 0; i < n; i++)
+                xmlRegSaveData(buf, regexp->transdata[i], saveData, ctxt);
+        }
+    }
+
+    xmlBinWriteInt(buf, regexp->dfa != NULL);
+    xmlBinWriteInt(buf, regexp->countMap != NULL);
+    xmlBinWriteInt(buf, regexp->required);
+}
+
+/*
+ * Reads a count and checks that the input can hold at least that
+ * many items of `size` bytes.
+ */
+static int
+xmlRegLoadCount(xmlBinReader *reader, int size) {
+    int n = xmlBinReadInt(reader);
+
+    if ((n < 0) || ((reader->end - reader->cur) / size < n)) {
+        reader->error = 1;
+        return(0);
+    }
+    return(n);
+}
+
+/**
+ * Reads a regexp written by xmlRegexpSave.
+ *
+ * @param reader  the input
+ * @param loadData  callback reading transition data, may be NULL if
+ * the regexp has none
+ * @param ctxt  user data of the callback
+ * @returns the regexp or NULL if the input is malformed or a memory
+ * allocation failed.
+ */
+xmlRegexp *
+xmlRegexpLoad(xmlBinReader *reader,
+              xmlRegLoadDataFunc loadData, void *ctxt) {
+    xmlRegexpPtr ret;
+    int i, j, n;
+
+    ret = (xmlRegexpPtr) xmlMalloc(sizeof(xmlRegexp));
+    if (ret == NULL)
+        return(NULL);
+    memset(ret, 0, sizeof(xmlRegexp));
+
+    ret->string = xmlBinReadStrdup(reader);
+    ret->determinist = xmlBinReadInt(reader);
+    ret->flags = xmlBinReadInt(reader);
+
+    n = xmlRegLoadCount(reader, 8);
+    if (n > 0) {
+        ret->counters = xmlMalloc(n * sizeof(xmlRegCounter));
+        if (ret->counters == NULL)
+            goto error;
+        ret->nbCounters = n;
+        for (i = 0; i < n; i++) {
+            ret->counters[i].min = xmlBinReadInt(reader);
+            ret->counters[i].max = xmlBinReadInt(reader);
+        }
+    }
+
+    n = xmlRegLoadCount(reader, 4);
+    if (n > 0) {
+        ret->atoms = xmlMalloc(n * sizeof(xmlRegAtomPtr));
+        if (ret->atoms == NULL)
+            goto error;
+        for (i = 0; i < n; i++) {
+            xmlRegAtomPtr atom;
+            int nbRanges;
+
+            atom = xmlRegNewAtom(NULL, xmlBinReadInt(reader));
+            if (atom == NULL)
+                goto error;
+            ret->atoms[i] = atom;
+            ret->nbAtoms = i + 1;
+            atom->no = i;
+            atom->quant = xmlBinReadInt(reader);
+            atom->min = xmlBinReadInt(reader);
+            atom->max = xmlBinReadInt(reader);
+            if ((atom->type == XML_REGEXP_STRING) ||
+                (atom->type == XML_REGEXP_BLOCK_NAME))
+                atom->valuep = xmlBinReadStrdup(reader);
+            if (atom->type == XML_REGEXP_STRING)
+                atom->valuep2 = xmlBinReadStrdup(reader);
+            atom->neg = xmlBinReadInt(reader);
+            atom->codepoint = xmlBinReadInt(reader);
+            nbRanges = xmlRegLoadCount(reader, 20);
+            if (nbRanges > 0) {
+                atom->ranges = xmlMalloc(nbRanges * sizeof(xmlRegRangePtr));
+                if (atom->ranges == NULL)
+                    goto error;
+                atom->maxRanges = nbRanges;
+                for (j = 0; j < nbRanges; j++) {
+                    xmlRegRangePtr range;
+                    int neg, type, start, end;
+
+                    neg = xmlBinReadInt(reader);
+                    type = xmlBinReadInt(reader);
+                    start = xmlBinReadInt(reader);
+                    end = xmlBinReadInt(reader);
+                    range = xmlRegNewRange(NULL, neg, type, start, end);
+                    if (range == NULL)
+                        goto error;
+                    atom->ranges[j] = range;
+                    atom->nbRanges = j + 1;
+                    range->blockName = xmlBinReadStrdup(reader);
+                }
+            }
+            atom->data = xmlRegLoadData(reader, loadData, ctxt);
+            if (reader->error)
+                goto error;
+        }
+    }
+
+    n = xmlRegLoadCount(reader, 4);
+    if (n > 0) {
+        ret->states = xmlMalloc(n * sizeof(xmlRegStatePtr));
+        if (ret->states == NULL)
+            goto error;
+        for (i = 0; i < n; i++) {
+            xmlRegStatePtr state;
+            int type, nbTrans;
+
+            ret->nbStates = i + 1;
+            ret->states[i] = NULL;
+            type = xmlBinReadInt(reader);
+            if (type == -1)
+                continue;
+            state = xmlRegNewState(NULL);
+            if (state == NULL)
+                goto error;
+            ret->states[i] = state;
+            state->type = type;
+            state->no = i;
+            nbTrans = xmlRegLoadCount(reader, 20);
+            if (nbTrans > 0) {
+                state->trans = xmlMalloc(nbTrans * sizeof(xmlRegTrans));
+                if (state->trans == NULL)
+                    goto error;
+                state->maxTrans = nbTrans;
+                state->nbTrans = nbTrans;
+                for (j = 0; j < nbTrans; j++) {
+                    xmlRegTransPtr trans = &state->trans[j];
+                    int atomno = xmlBinReadInt(reader);
+
+                    if ((atomno < -1) || (atomno >= ret->nbAtoms)) {
+                        reader->error = 1;
+                        atomno = -1;
+                    }
+                    trans->atom = atomno < 0 ? NULL : ret->atoms[atomno];
+                    trans->to = xmlBinReadInt(reader);
+                    trans->counter = xmlBinReadInt(reader);
+                    trans->count = xmlBinReadInt(reader);
+                    trans->nd = xmlBinReadInt(reader);
+                    /*
+                     * Eliminated transitions have negative targets,
+                     * transitions of <all> groups special counts.
+                     */
+                    if ((trans->to >= n) ||
+                        (trans->counter < -1) ||
+                        (trans->counter >= ret->nbCounters) ||
+                        (trans->count < -1) ||
+                        ((trans->count >= ret->nbCounters) &&
+                         (trans->count != REGEXP_ALL_COUNTER) &&
+                         (trans->count != REGEXP_ALL_LAX_COUNTER)))
+                        reader->error = 1;
+                }
+            }
+            if (reader->error)
+                goto error;
+        }
+    }
+
+    n = xmlBinReadInt(reader);
+    if (n >= 0) {
+        int nbstates = n, nbstrings = xmlBinReadInt(reader);
+
+        if ((nbstrings < 0) ||
+            ((reader->end - reader->cur) / 4 / (nbstrings + 1) <
+             nbstates + 1)) {
+            reader->error = 1;
+            goto error;
+        }
+        n = (nbstates + 1) * (nbstrings + 1);
+        ret->compact = xmlMalloc(n * sizeof(int));
+        ret->stringMap = xmlMalloc((nbstrings + 1) * sizeof(xmlChar *));
+        if ((ret->compact == NULL) || (ret->stringMap == NULL))
+            goto error;
+        ret->nbstates = nbstates;
+        for (i = 0; i < n; i++) {
+            ret->compact[i] = xmlBinReadInt(reader);
+            if ((i % (nbstrings + 1) != 0) &&
+                ((ret->compact[i] < 0) || (ret->compact[i] > nbstates)))
+                reader->error = 1;
+        }
+        for (i = 0; i < nbstrings; i++) {
+            ret->stringMap[i] = xmlBinReadStrdup(reader);
+            ret->nbstrings = i + 1;
+            if (ret->stringMap[i] == NULL) {
+                reader->error = 1;
+                goto error;
+            }
+        }
+        if (xmlBinReadInt(reader)) {
+            n = nbstates * nbstrings;
+            if (n > 0) {
+                ret->transdata = xmlMalloc(n * sizeof(void *));
+                if (ret->transdata == NULL)
+                    goto error;
+                for (i = 0; i < n; i++)
+                    ret->transdata[i] =
+                        xmlRegLoadData(reader, loadData, ctxt);
+            }
+        }
+    }
+
+    /* Optional, so ignore malloc failures */
+    if (xmlBinReadInt(reader))
+        ret->dfa = xmlRegDfaNew(ret);
+    if (xmlBinReadInt(reader))
+        ret->countMap = xmlRegCountNew(ret);
+    ret->required = xmlBinReadInt(reader);
+
+    if (reader->error)
+        goto error;
+    return(ret);
+
+error:
+    reader->error = 1;
+    xmlRegFreeRegexp(ret);
+    return(NULL);
+}
+
 /************************************************************************
  *									*
  *			The Automata interface				*
@@ -14,6 +14,7 @@
 #include <string.h>
 #include <libxml/xmlmemory.h>
 #include <libxml/parserInternals.h>
+#include <libxml/threads.h>
 #include <libxml/tree.h>
 #include <libxml/xmlsave.h>
 
@@ -26,8 +27,19 @@
 #include "private/error.h"
 #include "private/html.h"
 #include "private/io.h"
+#include "private/memory.h"
 #include "private/save.h"
 
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #include <pthread.h>
+  #define XML_SAVE_PARALLEL
+#endif
+
+/*
+ * Default minimum number of nodes per chunk, see xmlSaveSetParallel.
+ */
+#define XML_SAVE_PARALLEL_MIN_NODES 2000
+
 #ifdef LIBXML_OUTPUT_ENABLED
 
 #define XHTML_NS_NAME BAD_CAST "http://www.w3.org/1999/xhtml"
@@ -43,6 +55,11 @@ struct _xmlSaveCtxt {
     int indent_nr;
     int indent_size;
     xmlCharEncodingOutputFunc escape;	/* used for element content */
+    int nbThreads;
+    int minNodes;
+    struct _xmlSaveParallel *par;	/* state of a parallel save */
+    xmlNodePtr parNext;		/* first node of the next chunk */
+    xmlBufferPtr target;	/* buffer of xmlSaveToBuffer */
 };
 
 /************************************************************************
@@ -142,6 +159,48 @@ xmlSaveSetIndentString(xmlSaveCtxt *ctxt, const char *indent) {
     return(0);
 }
 
+/**
+ * Serialize large subtrees with multiple threads.
+ *
+ * Elements with at least twice `minNodes` descendants are split into
+ * chunks of sibling nodes which are serialized by worker threads into
+ * memory buffers and written out in document order. The output is
+ * the same as with a single thread.
+ *
+ * The document must not be modified while saving. Only output
+ * without character conversion, for example UTF-8, is parallelized.
+ * Errors in worker threads are reported to the error handlers of
+ * these threads.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  save context
+ * @param nbThreads  maximum number of threads or 0 to disable
+ * @param minNodes  minimum number of nodes per chunk or 0 for the
+ * default
+ * @returns 0 on success or -1 if threads aren't supported.
+ */
+int
+xmlSaveSetParallel(xmlSaveCtxt *ctxt, int nbThreads, int minNodes) {
+    if (ctxt == NULL)
+        return(-1);
+
+    if (nbThreads <= 1) {
+        ctxt->nbThreads = 0;
+        return(0);
+    }
+
+#ifdef XML_SAVE_PARALLEL
+    ctxt->nbThreads = nbThreads;
+    ctxt->minNodes = (minNodes > 0) ?
+                     minNodes : XML_SAVE_PARALLEL_MIN_NODES;
+    return(0);
+#else
+    (void) minNodes;
+    return(-1);
+#endif
+}
+
 /**
  * Initialize a saving context
  *
@@ -164,6 +223,14 @@ xmlSaveCtxtInit(xmlSaveCtxtPtr ctxt, int options)
         (xmlSaveNoEmptyTags))
 	options |= XML_SAVE_NO_EMPTY;
 
+    /*
+     * Resolve the thread-local indentation setting here, so that
+     * serializing nodes doesn't have to look it up.
+     */
+    if ((options & (XML_SAVE_INDENT | XML_SAVE_NO_INDENT)) == 0)
+        options |= xmlIndentTreeOutput ? XML_SAVE_INDENT :
+                                         XML_SAVE_NO_INDENT;
+
     ctxt->options = options;
 }
 
@@ -712,20 +779,156 @@ static int
 xmlSaveDocInternal(xmlSaveCtxtPtr ctxt, xmlDocPtr cur,
                    const xmlChar *encoding);
 
-static void
-xmlSaveWriteIndent(xmlSaveCtxtPtr ctxt, int extra)
+static int
+xmlSaveIndentSize(xmlSaveCtxtPtr ctxt, int extra)
 {
     int level;
 
     if ((ctxt->options & XML_SAVE_NO_INDENT) ||
-        (((ctxt->options & XML_SAVE_INDENT) == 0) &&
-         (xmlIndentTreeOutput == 0)))
-        return;
+        ((ctxt->options & XML_SAVE_INDENT) == 0))
+        return(0);
 
     level = ctxt->level + extra;
     if (level > ctxt->indent_nr)
         level = ctxt->indent_nr;
-    xmlOutputBufferWrite(ctxt->buf, ctxt->indent_size * level, ctxt->indent);
+    return(ctxt->indent_size * level);
+}
+
+static void
+xmlSaveWriteIndent(xmlSaveCtxtPtr ctxt, int extra)
+{
+    int size = xmlSaveIndentSize(ctxt, extra);
+
+    if (size > 0)
+        xmlOutputBufferWrite(ctxt->buf, size, ctxt->indent);
+}
+
+/*
+ * Without an encoder, tags are assembled directly in the output
+ * buffer with a single reservation instead of several short calls
+ * to xmlOutputBufferWrite, each of which checks the encoder and
+ * whether to flush.
+ *
+ * Flushing threshold of xmlOutputBufferWrite, see MINLEN in xmlIO.c.
+ */
+#define XML_SAVE_FLUSH_SIZE 4000
+
+/**
+ * Reserve space for writing directly into the output buffer.
+ *
+ * @param buf  the output buffer
+ * @param len  number of bytes
+ * @returns the end of the buffer content or NULL if the regular
+ * output functions must be used.
+ */
+static xmlChar *
+xmlSaveReserveRaw(xmlOutputBufferPtr buf, size_t len) {
+    if ((buf->encoder != NULL) || (buf->error != 0) ||
+        (xmlBufGrow(buf->buffer, len) < 0))
+        return(NULL);
+    return(xmlBufEnd(buf->buffer));
+}
+
+/**
+ * Commit bytes written directly into the output buffer and flush
+ * it like xmlOutputBufferWrite.
+ *
+ * @param buf  the output buffer
+ * @param len  number of bytes written
+ */
+static void
+xmlSaveCommitRaw(xmlOutputBufferPtr buf, size_t len) {
+    xmlBufAddLen(buf->buffer, len);
+    if ((buf->writecallback != NULL) &&
+        (xmlBufUse(buf->buffer) >= XML_SAVE_FLUSH_SIZE))
+        xmlOutputBufferWrite(buf, 0, "");
+}
+
+/**
+ * Write a short string.
+ *
+ * @param buf  the output buffer
+ * @param data  the string
+ * @param len  length of the string
+ */
+static void
+xmlSaveWriteRaw(xmlOutputBufferPtr buf, const char *data, size_t len) {
+    xmlChar *out = xmlSaveReserveRaw(buf, len);
+
+    if (out == NULL) {
+        xmlOutputBufferWrite(buf, len, data);
+        return;
+    }
+    memcpy(out, data, len);
+    xmlSaveCommitRaw(buf, len);
+}
+
+/**
+ * Write indentation followed by a qualified name between two short
+ * strings, for example a start or end tag or the start of an
+ * attribute.
+ *
+ * @param ctxt  the save context
+ * @param indent  number of indentation bytes
+ * @param before  string before the name
+ * @param beforeLen  length of `before`
+ * @param ns  namespace of the name (optional)
+ * @param name  the local name
+ * @param after  string after the name
+ * @param afterLen  length of `after`
+ */
+static void
+xmlSaveWriteQName(xmlSaveCtxtPtr ctxt, int indent,
+                  const char *before, size_t beforeLen, xmlNsPtr ns,
+                  const xmlChar *name, const char *after, size_t afterLen) {
+    xmlOutputBufferPtr buf = ctxt->buf;
+    const xmlChar *prefix = NULL;
+    size_t prefixLen = 0, nameLen;
+    xmlChar *out, *p;
+
+    if ((ns != NULL) && (ns->prefix != NULL)) {
+        prefix = ns->prefix;
+        prefixLen = strlen((const char *) prefix);
+    }
+    if (name == NULL)
+        name = BAD_CAST "";
+    nameLen = strlen((const char *) name);
+
+    out = xmlSaveReserveRaw(buf, indent + beforeLen + prefixLen + 1 +
+                                 nameLen + afterLen);
+    if (out == NULL) {
+        if (indent > 0)
+            xmlOutputBufferWrite(buf, indent, ctxt->indent);
+        xmlOutputBufferWrite(buf, beforeLen, before);
+        if (prefix != NULL) {
+            xmlOutputBufferWrite(buf, prefixLen, (const char *) prefix);
+            xmlOutputBufferWrite(buf, 1, ":");
+        }
+        xmlOutputBufferWrite(buf, nameLen, (const char *) name);
+        if (afterLen > 0)
+            xmlOutputBufferWrite(buf, afterLen, after);
+        return;
+    }
+
+    p = out;
+    if (indent > 0) {
+        memcpy(p, ctxt->indent, indent);
+        p += indent;
+    }
+    memcpy(p, before, beforeLen);
+    p += beforeLen;
+    if (prefix != NULL) {
+        memcpy(p, prefix, prefixLen);
+        p += prefixLen;
+        *p++ = ':';
+    }
+    memcpy(p, name, nameLen);
+    p += nameLen;
+    if (afterLen > 0) {
+        memcpy(p, after, afterLen);
+        p += afterLen;
+    }
+    xmlSaveCommitRaw(buf, p - out);
 }
 
 /**
@@ -884,16 +1087,12 @@ xmlAttrDumpOutput(xmlSaveCtxtPtr ctxt, xmlAttrPtr cur) {
     if (cur == NULL) return;
     buf = ctxt->buf;
     if (buf == NULL) return;
-    if (ctxt->format == 2)
+    if (ctxt->format == 2) {
         xmlOutputBufferWriteWSNonSig(ctxt, 2);
-    else
-        xmlOutputBufferWrite(buf, 1, " ");
-    if ((cur->ns != NULL) && (cur->ns->prefix != NULL)) {
-        xmlOutputBufferWriteString(buf, (const char *)cur->ns->prefix);
-	xmlOutputBufferWrite(buf, 1, ":");
+        xmlSaveWriteQName(ctxt, 0, "", 0, cur->ns, cur->name, "=\"", 2);
+    } else {
+        xmlSaveWriteQName(ctxt, 0, " ", 1, cur->ns, cur->name, "=\"", 2);
     }
-    xmlOutputBufferWriteString(buf, (const char *)cur->name);
-    xmlOutputBufferWrite(buf, 2, "=\"");
 #ifdef LIBXML_HTML_ENABLED
     if ((ctxt->options & XML_SAVE_XHTML) &&
         (cur->ns == NULL) &&
@@ -907,7 +1106,7 @@ xmlAttrDumpOutput(xmlSaveCtxtPtr ctxt, xmlAttrPtr cur) {
     {
         xmlSaveWriteAttrContent(ctxt, cur);
     }
-    xmlOutputBufferWrite(buf, 1, "\"");
+    xmlSaveWriteRaw(buf, "\"", 1);
 }
 
 #ifdef LIBXML_HTML_ENABLED
@@ -951,6 +1150,345 @@ htmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
 }
 #endif
 
+/************************************************************************
+ *									*
+ *			Parallel serialization				*
+ *									*
+ ************************************************************************/
+
+#ifdef XML_SAVE_PARALLEL
+
+/*
+ * The subtree to save is split into chunks, runs of siblings with
+ * roughly the same number of nodes. Worker threads serialize chunks
+ * in document order into memory buffers, at most `window` chunks
+ * ahead of the calling thread. The calling thread walks the rest of
+ * the tree, copies the output of chunks when it reaches them or
+ * serializes them directly if no worker took them yet.
+ *
+ * Serialization only depends on the indentation level and the
+ * formatting mode of the save context at the start of a chunk, so
+ * the result is the same as with a single thread.
+ */
+
+#define XML_SAVE_CHUNK_DONE 1
+
+typedef struct {
+    xmlNodePtr first;
+    xmlNodePtr last;
+    int level;
+    int format;
+    int state;
+    xmlOutputBufferPtr out;
+} xmlSaveChunk;
+
+struct _xmlSaveParallel {
+    /* save context of workers without output buffer */
+    xmlSaveCtxt tmpl;
+    size_t chunkSize;
+    xmlSaveChunk *chunks;
+    int nbChunks;
+    int maxChunks;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* next chunk to serialize */
+    int next;
+    /* next chunk of the calling thread */
+    int current;
+    int window;
+    int stop;
+};
+
+static void
+xmlSaveWriteChunk(xmlSaveCtxtPtr ctxt, xmlSaveChunk *chunk) {
+    xmlNodePtr cur = chunk->first;
+
+    while (1) {
+        if ((ctxt->format == 1) &&
+            ((cur->type == XML_ELEMENT_NODE) ||
+             (cur->type == XML_PI_NODE) ||
+             (cur->type == XML_COMMENT_NODE)))
+            xmlSaveWriteIndent(ctxt, 0);
+        xmlNodeDumpOutputInternal(ctxt, cur);
+        if (cur == chunk->last)
+            break;
+        if ((ctxt->format == 1) &&
+            (cur->type != XML_XINCLUDE_START) &&
+            (cur->type != XML_XINCLUDE_END))
+            xmlOutputBufferWrite(ctxt->buf, 1, "\n");
+        cur = cur->next;
+    }
+}
+
+/*
+ * Count the nodes of a subtree, stopping after `max` nodes.
+ */
+static size_t
+xmlSaveCountNodes(xmlNodePtr tree, size_t max) {
+    xmlNodePtr cur = tree;
+    size_t count = 0;
+
+    while (1) {
+        count++;
+        if (count > max)
+            return(count);
+        if ((cur->type == XML_ELEMENT_NODE) && (cur->children != NULL)) {
+            cur = cur->children;
+            continue;
+        }
+        while (cur->next == NULL) {
+            if (cur == tree)
+                return(count);
+            cur = cur->parent;
+        }
+        if (cur == tree)
+            return(count);
+        cur = cur->next;
+    }
+}
+
+static int
+xmlSaveAddChunk(struct _xmlSaveParallel *par, xmlNodePtr first,
+                xmlNodePtr last, int level, int format) {
+    xmlSaveChunk *chunk;
+
+    if (par->nbChunks >= par->maxChunks) {
+        xmlSaveChunk *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(par->maxChunks, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(par->chunks, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        par->chunks = tmp;
+        par->maxChunks = newSize;
+    }
+
+    chunk = &par->chunks[par->nbChunks++];
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->first = first;
+    chunk->last = last;
+    chunk->level = level;
+    chunk->format = format;
+    return(0);
+}
+
+/*
+ * Split the children of an element into chunks. Children with more
+ * than twice the chunk size are split recursively, so that the
+ * calling thread only serializes their start and end tags.
+ */
+static int
+xmlSavePlanChunks(struct _xmlSaveParallel *par, xmlNodePtr elem,
+                  int level, int format, int depth) {
+    xmlNodePtr cur, first = NULL, last = NULL;
+    size_t size, runSize = 0;
+
+    /* Same as xmlNodeDumpOutputInternal */
+    if (format == 1) {
+        for (cur = elem->children; cur != NULL; cur = cur->next) {
+            if ((cur->type == XML_TEXT_NODE) ||
+                (cur->type == XML_CDATA_SECTION_NODE) ||
+                (cur->type == XML_ENTITY_REF_NODE)) {
+                format = 0;
+                break;
+            }
+        }
+    }
+    if (level >= 0)
+        level++;
+
+    for (cur = elem->children; cur != NULL; cur = cur->next) {
+        if (cur->parent != elem)
+            return(-1);
+
+        size = xmlSaveCountNodes(cur, 2 * par->chunkSize);
+        if ((size > 2 * par->chunkSize) &&
+            (cur->type == XML_ELEMENT_NODE) &&
+            (depth < 16)) {
+            if ((first != NULL) &&
+                (xmlSaveAddChunk(par, first, last, level, format) < 0))
+                return(-1);
+            first = NULL;
+            runSize = 0;
+            if (xmlSavePlanChunks(par, cur, level, format, depth + 1) < 0)
+                return(-1);
+            continue;
+        }
+
+        if (first == NULL)
+            first = cur;
+        last = cur;
+        runSize += size;
+        if (runSize >= par->chunkSize) {
+            if (xmlSaveAddChunk(par, first, last, level, format) < 0)
+                return(-1);
+            first = NULL;
+            runSize = 0;
+        }
+    }
+
+    if ((first != NULL) &&
+        (xmlSaveAddChunk(par, first, last, level, format) < 0))
+        return(-1);
+    return(0);
+}
+
+static void
+xmlSaveWorkerRun(void *data) {
+    struct _xmlSaveParallel *par = data;
+    xmlSaveCtxt ctxt;
+    xmlSaveChunk *chunk;
+    xmlOutputBufferPtr out;
+
+    pthread_mutex_lock(&par->lock);
+    while (1) {
+        while ((!par->stop) && (par->next < par->nbChunks) &&
+               (par->next >= par->current + par->window))
+            pthread_cond_wait(&par->cond, &par->lock);
+        if ((par->stop) || (par->next >= par->nbChunks))
+            break;
+        chunk = &par->chunks[par->next++];
+        pthread_mutex_unlock(&par->lock);
+
+        out = xmlAllocOutputBuffer(NULL);
+        if (out != NULL) {
+            memcpy(&ctxt, &par->tmpl, sizeof(ctxt));
+            ctxt.buf = out;
+            ctxt.level = chunk->level;
+            ctxt.format = chunk->format;
+            xmlSaveWriteChunk(&ctxt, chunk);
+        }
+
+        pthread_mutex_lock(&par->lock);
+        chunk->out = out;
+        chunk->state = XML_SAVE_CHUNK_DONE;
+        pthread_cond_broadcast(&par->cond);
+    }
+    pthread_mutex_unlock(&par->lock);
+}
+
+/*
+ * Called by xmlNodeDumpOutputInternal when it reaches the next
+ * chunk. Returns the last node of the chunk.
+ */
+static xmlNodePtr
+xmlSaveParallelChunk(xmlSaveCtxtPtr ctxt) {
+    struct _xmlSaveParallel *par = ctxt->par;
+    xmlSaveChunk *chunk = &par->chunks[par->current];
+    xmlOutputBufferPtr out;
+    int own = 0;
+
+    pthread_mutex_lock(&par->lock);
+    if (par->next == par->current) {
+        par->next++;
+        own = 1;
+    }
+    par->current++;
+    pthread_cond_broadcast(&par->cond);
+    if (!own) {
+        while (chunk->state != XML_SAVE_CHUNK_DONE)
+            pthread_cond_wait(&par->cond, &par->lock);
+    }
+    pthread_mutex_unlock(&par->lock);
+
+    ctxt->parNext = (par->current < par->nbChunks) ?
+                    par->chunks[par->current].first : NULL;
+
+    if (own) {
+        xmlSaveWriteChunk(ctxt, chunk);
+    } else {
+        out = chunk->out;
+        chunk->out = NULL;
+        if (out == NULL) {
+            xmlSaveErrMemory(ctxt->buf);
+        } else {
+            if ((out->error) && (ctxt->buf->error == 0))
+                ctxt->buf->error = out->error;
+            else
+                xmlOutputBufferWrite(ctxt->buf, xmlBufUse(out->buffer),
+                        (const char *) xmlBufContent(out->buffer));
+            xmlOutputBufferClose(out);
+        }
+    }
+
+    return(chunk->last);
+}
+
+/*
+ * Serialize an element with multiple threads. Returns -1 if the
+ * subtree is too small or can't be split.
+ */
+static int
+xmlSaveParallel(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
+    struct _xmlSaveParallel par;
+    xmlTaskGroup *group;
+    int i, nbThreads;
+
+    memset(&par, 0, sizeof(par));
+    par.chunkSize = ctxt->minNodes;
+    if (xmlSaveCountNodes(cur, 2 * par.chunkSize) <= 2 * par.chunkSize)
+        return(-1);
+    if ((xmlSavePlanChunks(&par, cur, ctxt->level, ctxt->format, 0) < 0) ||
+        (par.nbChunks < 2)) {
+        xmlFree(par.chunks);
+        return(-1);
+    }
+
+    nbThreads = ctxt->nbThreads - 1;
+    if (nbThreads > par.nbChunks - 1)
+        nbThreads = par.nbChunks - 1;
+
+    /*
+     * The indentation setting of this thread was resolved into the
+     * options when the context was created, so workers see it too.
+     */
+    memcpy(&par.tmpl, ctxt, sizeof(par.tmpl));
+    par.tmpl.buf = NULL;
+    par.tmpl.nbThreads = 0;
+    par.tmpl.par = NULL;
+    par.tmpl.parNext = NULL;
+    par.window = 2 * ctxt->nbThreads;
+
+    /*
+     * Workers only wait for the calling thread which writes the
+     * chunks nobody took, so tasks which don't start before the end
+     * are harmless.
+     */
+    pthread_mutex_init(&par.lock, NULL);
+    pthread_cond_init(&par.cond, NULL);
+    group = xmlNewTaskGroup();
+    for (i = 0; i < nbThreads; i++)
+        xmlTaskGroupSubmit(group, xmlSaveWorkerRun, &par);
+
+    ctxt->par = &par;
+    ctxt->parNext = par.chunks[0].first;
+    xmlNodeDumpOutputInternal(ctxt, cur);
+    ctxt->par = NULL;
+    ctxt->parNext = NULL;
+
+    pthread_mutex_lock(&par.lock);
+    par.stop = 1;
+    pthread_cond_broadcast(&par.cond);
+    pthread_mutex_unlock(&par.lock);
+    xmlFreeTaskGroup(group);
+    pthread_cond_destroy(&par.cond);
+    pthread_mutex_destroy(&par.lock);
+
+    for (i = 0; i < par.nbChunks; i++) {
+        if (par.chunks[i].out != NULL)
+            xmlOutputBufferClose(par.chunks[i].out);
+    }
+
+    xmlFree(par.chunks);
+    return(0);
+}
+
+#endif /* XML_SAVE_PARALLEL */
+
 /**
  * Dump an XML node, recursive behaviour, children are printed too.
  *
@@ -960,6 +1498,7 @@ htmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
 static void
 xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
     int format = ctxt->format;
+    int indent;
     xmlNodePtr tmp, root, unformattedNode = NULL, parent;
     xmlAttrPtr attr;
     xmlChar *start, *end;
@@ -968,9 +1507,24 @@ xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
     if (cur == NULL) return;
     buf = ctxt->buf;
 
+#ifdef XML_SAVE_PARALLEL
+    if ((ctxt->nbThreads > 1) && (ctxt->par == NULL) &&
+        (cur->type == XML_ELEMENT_NODE) && (ctxt->escape == NULL) &&
+        (buf->encoder == NULL) &&
+        (xmlSaveParallel(ctxt, cur) == 0))
+        return;
+#endif
+
     root = cur;
     parent = cur->parent;
     while (1) {
+#ifdef XML_SAVE_PARALLEL
+        if ((cur == ctxt->parNext) && (cur != NULL)) {
+            cur = xmlSaveParallelChunk(ctxt);
+            goto next;
+        }
+#endif
+
         switch (cur->type) {
         case XML_DOCUMENT_NODE:
         case XML_HTML_DOCUMENT_NODE:
@@ -1004,7 +1558,9 @@ xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
 
         case XML_ELEMENT_NODE:
 	    if ((cur != root) && (ctxt->format == 1))
-                xmlSaveWriteIndent(ctxt, 0);
+                indent = xmlSaveIndentSize(ctxt, 0);
+            else
+                indent = 0;
 
             /*
              * Some users like lxml are known to pass nodes with a corrupted
@@ -1012,16 +1568,28 @@ xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
              * case.
              */
             if ((cur->parent != parent) && (cur->children != NULL)) {
+                xmlOutputBufferWrite(buf, indent, ctxt->indent);
                 xmlNodeDumpOutputInternal(ctxt, cur);
                 break;
             }
 
-            xmlOutputBufferWrite(buf, 1, "<");
-            if ((cur->ns != NULL) && (cur->ns->prefix != NULL)) {
-                xmlOutputBufferWriteString(buf, (const char *)cur->ns->prefix);
-                xmlOutputBufferWrite(buf, 1, ":");
+            /* Copy unmodified elements from the source text. */
+            if ((cur->doc != NULL) && (cur->doc->source != NULL) &&
+                (ctxt->format == 0) && (ctxt->escape == NULL) &&
+                (buf->encoder == NULL) &&
+                ((ctxt->options & XML_SAVE_NO_EMPTY) == 0)) {
+                const xmlChar *text;
+                size_t len;
+
+                text = xmlNodeGetSource(cur, &len);
+                if ((text != NULL) && (len <= INT_MAX)) {
+                    xmlOutputBufferWrite(buf, len, (const char *) text);
+                    break;
+                }
             }
-            xmlOutputBufferWriteString(buf, (const char *)cur->name);
+
+            xmlSaveWriteQName(ctxt, indent, "<", 1, cur->ns, cur->name,
+                              NULL, 0);
             if (cur->nsDef)
                 xmlNsListDumpOutputCtxt(ctxt, cur->nsDef);
             for (attr = cur->properties; attr != NULL; attr = attr->next)
@@ -1031,20 +1599,16 @@ xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
                 if ((ctxt->options & XML_SAVE_NO_EMPTY) == 0) {
                     if (ctxt->format == 2)
                         xmlOutputBufferWriteWSNonSig(ctxt, 0);
-                    xmlOutputBufferWrite(buf, 2, "/>");
-                } else {
-                    if (ctxt->format == 2)
-                        xmlOutputBufferWriteWSNonSig(ctxt, 1);
-                    xmlOutputBufferWrite(buf, 3, "></");
-                    if ((cur->ns != NULL) && (cur->ns->prefix != NULL)) {
-                        xmlOutputBufferWriteString(buf,
-                                (const char *)cur->ns->prefix);
-                        xmlOutputBufferWrite(buf, 1, ":");
-                    }
-                    xmlOutputBufferWriteString(buf, (const char *)cur->name);
-                    if (ctxt->format == 2)
-                        xmlOutputBufferWriteWSNonSig(ctxt, 0);
+                    xmlSaveWriteRaw(buf, "/>", 2);
+                } else if (ctxt->format == 2) {
+                    xmlOutputBufferWriteWSNonSig(ctxt, 1);
+                    xmlSaveWriteQName(ctxt, 0, "></", 3, cur->ns, cur->name,
+                                      NULL, 0);
+                    xmlOutputBufferWriteWSNonSig(ctxt, 0);
                     xmlOutputBufferWrite(buf, 1, ">");
+                } else {
+                    xmlSaveWriteQName(ctxt, 0, "></", 3, cur->ns, cur->name,
+                                      ">", 1);
                 }
             } else {
                 if (ctxt->format == 1) {
@@ -1062,8 +1626,7 @@ xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
                 }
                 if (ctxt->format == 2)
                     xmlOutputBufferWriteWSNonSig(ctxt, 1);
-                xmlOutputBufferWrite(buf, 1, ">");
-                if (ctxt->format == 1) xmlOutputBufferWrite(buf, 1, "\n");
+                xmlSaveWriteRaw(buf, ">\n", (ctxt->format == 1) ? 2 : 1);
                 if (ctxt->level >= 0) ctxt->level++;
                 parent = cur;
                 cur = cur->children;
@@ -1172,13 +1735,16 @@ xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
             break;
         }
 
+#ifdef XML_SAVE_PARALLEL
+next:
+#endif
         while (1) {
             if (cur == root)
                 return;
             if ((ctxt->format == 1) &&
                 (cur->type != XML_XINCLUDE_START) &&
                 (cur->type != XML_XINCLUDE_END))
-                xmlOutputBufferWrite(buf, 1, "\n");
+                xmlSaveWriteRaw(buf, "\n", 1);
             if (cur->next != NULL) {
                 cur = cur->next;
                 break;
@@ -1190,20 +1756,18 @@ xmlNodeDumpOutputInternal(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
 
             if (cur->type == XML_ELEMENT_NODE) {
                 if (ctxt->level > 0) ctxt->level--;
-                if (ctxt->format == 1)
-                    xmlSaveWriteIndent(ctxt, 0);
-
-                xmlOutputBufferWrite(buf, 2, "</");
-                if ((cur->ns != NULL) && (cur->ns->prefix != NULL)) {
-                    xmlOutputBufferWriteString(buf,
-                            (const char *)cur->ns->prefix);
-                    xmlOutputBufferWrite(buf, 1, ":");
-                }
 
-                xmlOutputBufferWriteString(buf, (const char *)cur->name);
-                if (ctxt->format == 2)
+                if (ctxt->format == 2) {
+                    xmlSaveWriteQName(ctxt, 0, "</", 2, cur->ns, cur->name,
+                                      NULL, 0);
                     xmlOutputBufferWriteWSNonSig(ctxt, 0);
-                xmlOutputBufferWrite(buf, 1, ">");
+                    xmlOutputBufferWrite(buf, 1, ">");
+                } else {
+                    indent = (ctxt->format == 1) ?
+                             xmlSaveIndentSize(ctxt, 0) : 0;
+                    xmlSaveWriteQName(ctxt, indent, "</", 2, cur->ns,
+                                      cur->name, ">", 1);
+                }
 
                 if (cur == unformattedNode) {
                     ctxt->format = format;
@@ -1905,6 +2469,7 @@ xmlSaveToBuffer(xmlBuffer *buffer, const char *encoding, int options)
 	xmlFreeSaveCtxt(ret);
 	return(NULL);
     }
+    ret->target = buffer;
     return(ret);
 }
 
@@ -1943,6 +2508,61 @@ xmlSaveToIO(xmlOutputWriteCallback iowrite,
     return(ret);
 }
 
+/*
+ * Write callback of the measuring pass which only counts bytes.
+ */
+static int
+xmlSaveCountWrite(void *context, const char *buffer ATTRIBUTE_UNUSED,
+                  int len) {
+    size_t *count = context;
+
+    *count += len;
+    return(len);
+}
+
+/**
+ * Compute the size of the serialized output by saving to a counting
+ * output buffer with a copy of the context, then grow the target
+ * buffer once to hold it. Errors only cause the reservation to be
+ * skipped, they're reported by the actual serialization.
+ *
+ * @param ctxt  a save context created with xmlSaveToBuffer
+ * @param cur  a document or the root of a subtree
+ */
+static void
+xmlSaveReserve(xmlSaveCtxtPtr ctxt, xmlNodePtr cur) {
+    xmlSaveCtxt measure;
+    xmlCharEncodingHandlerPtr handler = NULL;
+    size_t count = 0;
+
+    if ((ctxt->buf->encoder != NULL) &&
+        (xmlOpenCharEncodingHandler((const char *) ctxt->encoding,
+                                    /* output */ 1, &handler) != XML_ERR_OK))
+        return;
+
+    measure = *ctxt;
+    measure.options &= ~XML_SAVE_MEASURE;
+    measure.buf = xmlOutputBufferCreateIO(xmlSaveCountWrite, NULL, &count,
+                                          handler);
+    if (measure.buf == NULL) {
+        xmlCharEncCloseFunc(handler);
+        return;
+    }
+
+    if ((cur->type == XML_DOCUMENT_NODE) ||
+        (cur->type == XML_HTML_DOCUMENT_NODE))
+        xmlSaveDoc(&measure, (xmlDocPtr) cur);
+    else
+        xmlSaveTree(&measure, cur);
+
+    if ((xmlOutputBufferClose(measure.buf) < 0) || (count >= INT_MAX))
+        return;
+
+    /* Pending output must be accounted for. */
+    xmlOutputBufferFlush(ctxt->buf);
+    xmlBufferGrow(ctxt->target, count);
+}
+
 /**
  * Serialize a document.
  *
@@ -1960,6 +2580,8 @@ xmlSaveDoc(xmlSaveCtxt *ctxt, xmlDoc *doc)
     long ret = 0;
 
     if ((ctxt == NULL) || (doc == NULL)) return(-1);
+    if ((ctxt->options & XML_SAVE_MEASURE) && (ctxt->target != NULL))
+        xmlSaveReserve(ctxt, (xmlNodePtr) doc);
     if (xmlSaveDocInternal(ctxt, doc, ctxt->encoding) < 0)
         return(-1);
     return(ret);
@@ -1980,6 +2602,8 @@ xmlSaveTree(xmlSaveCtxt *ctxt, xmlNode *cur)
     long ret = 0;
 
     if ((ctxt == NULL) || (cur == NULL)) return(-1);
+    if ((ctxt->options & XML_SAVE_MEASURE) && (ctxt->target != NULL))
+        xmlSaveReserve(ctxt, cur);
 #ifdef LIBXML_HTML_ENABLED
     if (ctxt->options & XML_SAVE_XHTML) {
         xhtmlNodeDumpOutput(ctxt, cur);
@@ -2088,6 +2712,138 @@ xmlSaveFinish(xmlSaveCtxt *ctxt)
     return(ret);
 }
 
+/*
+ * Write callback for contexts reset to an xmlBuffer.
+ */
+static int
+xmlSaveBufferWrite(void *context, const char *buffer, int len) {
+    if (xmlBufferAdd((xmlBufferPtr) context, (const xmlChar *) buffer,
+                     len) != 0)
+        return(-XML_ERR_NO_MEMORY);
+    return(len);
+}
+
+/**
+ * Finish the current output and switch to a new one, keeping the
+ * output buffers and the encoder.
+ *
+ * @param ctxt  a document saving context
+ * @param iowrite  write callback of the new output
+ * @param ioclose  close callback of the new output
+ * @param ioctx  context of the new output
+ * @returns an xmlParserErrors code.
+ */
+static xmlParserErrors
+xmlSaveResetOutput(xmlSaveCtxtPtr ctxt, xmlOutputWriteCallback iowrite,
+                   xmlOutputCloseCallback ioclose, void *ioctx) {
+    xmlOutputBufferPtr buf = ctxt->buf;
+    xmlOutputBufferPtr newbuf;
+    xmlCharEncodingHandlerPtr handler = NULL;
+    xmlParserErrors ret;
+
+    if (buf->writecallback != NULL)
+        xmlOutputBufferFlush(buf);
+    if (buf->closecallback != NULL) {
+        int code = buf->closecallback(buf->context);
+
+        if ((code != XML_ERR_OK) &&
+            (!xmlIsCatastrophicError(XML_ERR_FATAL, buf->error)))
+            buf->error = (code < 0) ? XML_IO_UNKNOWN : code;
+    }
+    buf->writecallback = NULL;
+    buf->closecallback = NULL;
+    buf->context = NULL;
+    ret = buf->error;
+
+    ctxt->level = 0;
+
+    if (ret == XML_ERR_OK) {
+        xmlBufEmpty(buf->buffer);
+        buf->context = ioctx;
+        buf->writecallback = iowrite;
+        buf->closecallback = ioclose;
+        buf->written = 0;
+
+        /* Reset the encoder state, e.g. to output a BOM again */
+        if (buf->encoder != NULL) {
+            xmlBufEmpty(buf->conv);
+            xmlCharEncOutput(buf, 1);
+        }
+
+        return(XML_ERR_OK);
+    }
+
+    /*
+     * The buffers may be unusable after an error, start over with
+     * a new output buffer.
+     */
+    if ((ctxt->encoding != NULL) &&
+        (xmlOpenCharEncodingHandler((const char *) ctxt->encoding,
+                                    /* output */ 1, &handler) != XML_ERR_OK))
+        return(ret);
+    newbuf = xmlOutputBufferCreateIO(iowrite, ioclose, ioctx, handler);
+    if (newbuf == NULL) {
+        xmlCharEncCloseFunc(handler);
+        return(ret);
+    }
+    xmlOutputBufferClose(buf);
+    ctxt->buf = newbuf;
+
+    return(ret);
+}
+
+/**
+ * Reset a document saving context to serialize to new I/O callbacks.
+ *
+ * Pending output is flushed and the previous output is closed like
+ * with #xmlSaveFinish. The context keeps its options, indentation,
+ * encoder and the memory of its output buffers, so a series of
+ * documents can be serialized without creating a new context for
+ * each of them.
+ *
+ * If the previous output failed, its error is returned but the
+ * context is still reset to the new output unless memory
+ * allocation failed.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a document saving context
+ * @param iowrite  an I/O write function
+ * @param ioclose  an I/O close function (optional)
+ * @param ioctx  an I/O handler
+ * @returns an xmlParserErrors code of the previous output.
+ */
+xmlParserErrors
+xmlSaveCtxtReset(xmlSaveCtxt *ctxt, xmlOutputWriteCallback iowrite,
+                 xmlOutputCloseCallback ioclose, void *ioctx) {
+    if ((ctxt == NULL) || (ctxt->buf == NULL) || (iowrite == NULL))
+        return(XML_ERR_ARGUMENT);
+
+    ctxt->target = NULL;
+    return(xmlSaveResetOutput(ctxt, iowrite, ioclose, ioctx));
+}
+
+/**
+ * Reset a document saving context to serialize to a buffer.
+ *
+ * Works like #xmlSaveCtxtReset and makes the context behave as if
+ * it was created with #xmlSaveToBuffer.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a document saving context
+ * @param buffer  a buffer
+ * @returns an xmlParserErrors code of the previous output.
+ */
+xmlParserErrors
+xmlSaveCtxtResetBuffer(xmlSaveCtxt *ctxt, xmlBuffer *buffer) {
+    if ((ctxt == NULL) || (ctxt->buf == NULL) || (buffer == NULL))
+        return(XML_ERR_ARGUMENT);
+
+    ctxt->target = buffer;
+    return(xmlSaveResetOutput(ctxt, xmlSaveBufferWrite, NULL, buffer));
+}
+
 /**
  * Set a custom escaping function to be used for text in element
  * content.
@@ -55,7 +55,9 @@
 
 #ifdef LIBXML_SCHEMAS_ENABLED
 
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
 #include <libxml/parserInternals.h>
@@ -76,9 +78,23 @@
 #include <libxml/xmlreader.h>
 #endif
 
+#include "private/buf.h"
 #include "private/error.h"
+#include "private/hash.h"
+#include "private/io.h"
 #include "private/memory.h"
+#include "private/parser.h"
+#include "private/regexp.h"
+#include "private/schemas.h"
 #include "private/string.h"
+#include "private/threads.h"
+#include "private/trace.h"
+#include "private/tree.h"
+
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #include <pthread.h>
+  #define XML_SCHEMA_PARALLEL
+#endif
 
 /* #define WXS_ELEM_DECL_CONS_ENABLED */
 
@@ -98,6 +114,12 @@
 
 #define UNBOUNDED (1 << 30)
 
+/*
+ * Default minimum size of subtrees validated by worker threads, see
+ * xmlSchemaValidCtxtSetParallel.
+ */
+#define XML_SCHEMA_PARALLEL_MIN_NODES 1000
+
 #define XML_SCHEMAS_NO_NAMESPACE (const xmlChar *) "##"
 
 /*
@@ -558,6 +580,9 @@ struct _xmlSchemaRedef {
     xmlSchemaBucketPtr targetBucket; /* The redefined schema. */
 };
 
+typedef struct _xmlSchemaPrefetch xmlSchemaPrefetch;
+typedef xmlSchemaPrefetch *xmlSchemaPrefetchPtr;
+
 /**
  */
 typedef struct _xmlSchemaConstructionCtxt xmlSchemaConstructionCtxt;
@@ -574,6 +599,40 @@ struct _xmlSchemaConstructionCtxt {
     xmlHashTablePtr substGroups;
     xmlSchemaRedefPtr redefs;
     xmlSchemaRedefPtr lastRedef;
+    xmlSchemaPrefetchPtr prefetch; /* documents parsed ahead */
+};
+
+/*
+ * Imports whose schema documents are only loaded when their namespace
+ * is used, see xmlSchemaSetParserLazyImports. Imports requested while
+ * parsing are loaded before the components are fixed up, the other
+ * ones on demand during validation with the lock held.
+ */
+#define XML_SCHEMA_LAZY_PENDING 0
+#define XML_SCHEMA_LAZY_REQUESTED 1
+#define XML_SCHEMA_LAZY_LOADED 2
+
+typedef struct _xmlSchemaLazyImport xmlSchemaLazyImport;
+typedef xmlSchemaLazyImport *xmlSchemaLazyImportPtr;
+struct _xmlSchemaLazyImport {
+    const xmlChar *nsName;
+    const xmlChar *location; /* absolute URI or NULL */
+    const xmlChar *sourceNs; /* target namespace of the importing schema */
+    xmlSchemaBucketPtr owner; /* the importing schema document */
+    xmlNodePtr node; /* the <import> element */
+    int state;
+};
+
+typedef struct _xmlSchemaLazyImports xmlSchemaLazyImports;
+typedef xmlSchemaLazyImports *xmlSchemaLazyImportsPtr;
+struct _xmlSchemaLazyImports {
+    xmlSchemaLazyImportPtr items;
+    int nbItems;
+    int sizeItems;
+    xmlSchemaItemListPtr loaded; /* imports loaded during validation */
+    xmlResourceLoader resourceLoader;
+    void *resourceCtxt;
+    xmlMutex lock;
 };
 
 #define XML_SCHEMAS_PARSE_ERROR		1
@@ -629,6 +688,8 @@ struct _xmlSchemaParserCtxt {
 
     xmlResourceLoader resourceLoader;
     void *resourceCtxt;
+    int lazyImports;
+    int parseThreads;
 };
 
 /**
@@ -712,6 +773,7 @@ struct _xmlSchemaIDCSelect {
     int index; /* an index position if significant for IDC key-sequences */
     const xmlChar *xpath; /* the XPath expression */
     void *xpathComp; /* the compiled XPath expression */
+    const xmlChar **nsArray; /* the in-scope namespaces, for xmlSchemaSave */
 };
 
 /**
@@ -779,6 +841,8 @@ struct _xmlSchemaPSVIIDCBinding {
     int nbNodes; /* number of entries in the node table */
     int sizeNodes; /* size of the node table */
     xmlSchemaItemListPtr dupls;
+    xmlHashTablePtr nodeHash; /* index of the node table */
+    xmlHashTablePtr duplHash; /* index of the duplicates */
 };
 
 
@@ -829,6 +893,87 @@ struct _xmlSchemaIDCMatcher {
     xmlHashTablePtr htab;
 };
 
+/*
+* A particle of an <all> model group.
+*/
+typedef struct _xmlSchemaAllParticle xmlSchemaAllParticle;
+typedef xmlSchemaAllParticle *xmlSchemaAllParticlePtr;
+struct _xmlSchemaAllParticle {
+    xmlSchemaElementPtr decl;
+    int required; /* minOccurs is 1 */
+};
+
+/*
+* The content model of a complex type whose particle is an <all>
+* model group. Children are matched with a hash lookup and tracked
+* in a bitset instead of running the automaton, whose states have
+* one transition per particle.
+*/
+typedef struct _xmlSchemaAllModel xmlSchemaAllModel;
+typedef xmlSchemaAllModel *xmlSchemaAllModelPtr;
+struct _xmlSchemaAllModel {
+    int nbParticles;
+    int nbRequired;
+    int optional; /* the <all> group has minOccurs 0 */
+    xmlSchemaAllParticlePtr particles;
+    xmlHashTablePtr index; /* (name, namespace) -> particle */
+};
+
+/*
+* An index of the enumeration facets of a simple type, keyed by the
+* hash strings of the facet values, see xmlSchemaGetCanonValueHash.
+* Values with different hash strings are never equal if the index is
+* exact. Otherwise, the facets must be searched after a miss.
+*/
+typedef struct _xmlSchemaEnumEntry xmlSchemaEnumEntry;
+typedef xmlSchemaEnumEntry *xmlSchemaEnumEntryPtr;
+struct _xmlSchemaEnumEntry {
+    xmlSchemaEnumEntryPtr next; /* next facet with the same hash string */
+    xmlSchemaFacetPtr facet;
+};
+
+typedef struct _xmlSchemaEnumIndex xmlSchemaEnumIndex;
+typedef xmlSchemaEnumIndex *xmlSchemaEnumIndexPtr;
+struct _xmlSchemaEnumIndex {
+    int exact;
+    xmlSchemaEnumEntryPtr entries;
+    xmlHashTablePtr table; /* hash string -> entry */
+    xmlSchemaFacetLinkPtr links; /* the facetSet without enumerations */
+};
+
+/*
+* Don't index short lists of enumerations. Comparing a few values is
+* cheaper than computing the hash string.
+*/
+#define XML_SCHEMA_ENUM_INDEX_MIN 8
+
+/*
+* The namespace set of a wildcard in a hash table.
+*/
+typedef struct _xmlSchemaWildcardIndex xmlSchemaWildcardIndex;
+typedef xmlSchemaWildcardIndex *xmlSchemaWildcardIndexPtr;
+struct _xmlSchemaWildcardIndex {
+    xmlHashTablePtr table; /* namespace name -> wildcard */
+    int absent; /* the absent namespace is allowed */
+};
+
+/*
+* Don't index short namespace sets, searching them is cheaper.
+*/
+#define XML_SCHEMA_WILDCARD_INDEX_MIN 8
+
+/*
+* The state of an <all> model group during validation.
+*/
+typedef struct _xmlSchemaAllExec xmlSchemaAllExec;
+typedef xmlSchemaAllExec *xmlSchemaAllExecPtr;
+struct _xmlSchemaAllExec {
+    int nbSeen;
+    int nbRequiredSeen;
+    int *order; /* particle indices in document order */
+    unsigned char *seen; /* bitset of matched particles */
+};
+
 /*
 * Element info flags.
 */
@@ -871,6 +1016,7 @@ struct _xmlSchemaNodeInfo {
     xmlSchemaIDCMatcherPtr idcMatchers; /* the IDC matchers for the scope
                                            element */
     xmlRegExecCtxtPtr regexCtxt;
+    xmlSchemaAllExecPtr allExec; /* used instead of regexCtxt for <all> */
 
     const xmlChar **nsBindings; /* Namespace bindings on this element */
     int nbNsBindings;
@@ -932,6 +1078,87 @@ struct _xmlSchemaAttrInfo {
 /**
  * A Schemas validation context
  */
+/*
+ * Parallel validation splits a document into segments in document
+ * order: subtrees validated by worker threads and the parts between
+ * them, validated by the calling thread. Errors are collected per
+ * segment and reported in document order once all are done.
+ */
+typedef struct _xmlSchemaParSegment xmlSchemaParSegment;
+typedef xmlSchemaParSegment *xmlSchemaParSegmentPtr;
+struct _xmlSchemaParSegment {
+    xmlNodePtr elem; /* the root of a deferred subtree or NULL */
+    xmlSchemaElementPtr decl; /* the declaration of the root */
+    xmlErrorPtr errors;
+    int nbErrors;
+    int sizeErrors;
+    int nberrors; /* errors counted by the worker */
+    int ret; /* the result of the worker */
+    int noMemory;
+};
+
+typedef struct _xmlSchemaParRun xmlSchemaParRun;
+typedef xmlSchemaParRun *xmlSchemaParRunPtr;
+struct _xmlSchemaParRun {
+    xmlSchemaParSegmentPtr segs;
+    int nbSegs;
+    int sizeSegs;
+    int minNodes;
+    int smallDepth; /* depth of the last subtree found too small */
+    int next; /* the next segment to hand out */
+    xmlMutex lock; /* protects next */
+    xmlMutex idLock; /* serializes registration of IDs in the document */
+};
+
+/*
+ * Modified elements and their ancestors during revalidation, see
+ * xmlSchemaRevalidateDoc. Both arrays are sorted by address.
+ */
+typedef struct _xmlSchemaIncRun xmlSchemaIncRun;
+typedef xmlSchemaIncRun *xmlSchemaIncRunPtr;
+struct _xmlSchemaIncRun {
+    xmlNodePtr *nodes;
+    int nbNodes;
+    xmlNodePtr *path;
+    int nbPath;
+    int fullDepth; /* depth of the subtree validated completely or -1 */
+};
+
+/*
+ * Validation work timed by the profiler, see
+ * xmlSchemaValidCtxtSetProfile.
+ */
+typedef enum {
+    XML_SCHEMA_PROF_SIMPLE = 0,
+    XML_SCHEMA_PROF_AUTOMATON,
+    XML_SCHEMA_PROF_IDC,
+    XML_SCHEMA_PROF_WILDCARD,
+    XML_SCHEMA_PROF_MAX
+} xmlSchemaProfCategory;
+
+typedef struct {
+    xmlSchemaTypePtr type;
+    unsigned long elements;
+    unsigned long attributes;
+    unsigned long checks; /* values checked against the type */
+    double time; /* seconds spent checking values */
+} xmlSchemaTypeProfile;
+
+typedef struct _xmlSchemaValidProfile xmlSchemaValidProfile;
+typedef xmlSchemaValidProfile *xmlSchemaValidProfilePtr;
+struct _xmlSchemaValidProfile {
+    unsigned long elements;
+    unsigned long attributes;
+    unsigned long counts[XML_SCHEMA_PROF_MAX];
+    double times[XML_SCHEMA_PROF_MAX];
+    xmlSchemaTypeProfile *types;
+    int nbTypes;
+    int sizeTypes;
+    int *index; /* open addressing table of indices into types */
+    int sizeIndex;
+    int simpleDepth; /* nesting of simple type checks */
+};
+
 struct _xmlSchemaValidCtxt {
     int type;
     void *errCtxt;             /* user specific data block */
@@ -974,6 +1201,7 @@ struct _xmlSchemaValidCtxt {
     xmlSchemaIDCStateObjPtr xpathStates; /* first active state object. */
     xmlSchemaIDCStateObjPtr xpathStatePool; /* first stored state object. */
     xmlSchemaIDCMatcherPtr idcMatcherCache; /* Cache for IDC matcher objects. */
+    xmlRegExecPoolPtr execPool; /* Cache for content model regexp contexts. */
 
     xmlSchemaPSVIIDCNodePtr *idcNodes; /* list of all IDC node-table entries*/
     int nbIdcNodes;
@@ -994,6 +1222,15 @@ struct _xmlSchemaValidCtxt {
     xmlSchemaAttrInfoPtr *attrInfos;
     int nbAttrInfos;
     int sizeAttrInfos;
+    /* attribute values of the current start tag in streaming mode */
+    xmlChar *attrValues;
+    size_t sizeAttrValues;
+    /* parser reporting events directly, see xmlSchemaValidateAttach */
+    xmlParserCtxtPtr hookCtxt;
+    /* namespace last interned by the tree walker, see xmlSchemaWalkNsName */
+    xmlNsIdCache walkNsIds;
+    int walkNsId;
+    const xmlChar *walkNsName;
 
     int skipDepth;
     xmlSchemaItemListPtr nodeQNames;
@@ -1004,6 +1241,25 @@ struct _xmlSchemaValidCtxt {
     /* Locator for error reporting in streaming mode */
     xmlSchemaValidityLocatorFunc locFunc;
     void *locCtxt;
+
+    xmlMemBudget *memBudget;
+    xmlErrorPolicy *errorPolicy;
+
+    int parallelThreads;
+    int parallelMinNodes;
+    xmlSchemaParRunPtr parRun; /* collects subtrees for worker threads */
+    xmlSchemaParSegmentPtr parSink; /* collects errors in parallel mode */
+    xmlSchemaElementPtr parRootDecl; /* declaration of a deferred root */
+    xmlMutex *parIdLock;
+
+    xmlSchemaValidProfilePtr profile;
+    xmlSchemaIncRunPtr incRun; /* set during revalidation */
+    int lazyAugmented; /* lazily loaded imports with augmented IDCs */
+
+    int keepValues;
+    xmlSchemaNodeValue *values; /* values kept for the application */
+    int nbValues;
+    int sizeValues;
 };
 
 typedef struct _xmlSchemaSubstGroup xmlSchemaSubstGroup;
@@ -1076,6 +1332,12 @@ static xmlSchemaQNameRefPtr
 xmlSchemaParseAttributeGroupRef(xmlSchemaParserCtxtPtr pctxt,
 				xmlSchemaPtr schema,
 				xmlNodePtr node);
+static void
+xmlSchemaFreeAllModel(xmlSchemaAllModelPtr model);
+static void
+xmlSchemaFreeEnumIndex(xmlSchemaEnumIndexPtr index);
+static void
+xmlSchemaFreeWildcardIndex(xmlSchemaWildcardIndexPtr index);
 
 /************************************************************************
  *									*
@@ -1479,11 +1741,11 @@ xmlSchemaGetCanonValueWhtspExt_1(xmlSchemaValPtr val,
 		}
 		break;
 	    default:
-		if (xmlSchemaGetCanonValue(val, &value2) == -1) {
-		    if (value2 != NULL)
-			xmlFree((xmlChar *) value2);
+		/* The canonical value is cached in the value */
+		if (xmlSchemaValCanon(val, &value) < 0)
 		    goto internal_error;
-		}
+		if (value == NULL)
+		    value = BAD_CAST "";
 		if (for_hash && valType == XML_SCHEMAS_DECIMAL) {
 		    /* We can mostly use the canonical value for hashing,
 		       except in the case of decimal.  There the canonical
@@ -1494,11 +1756,14 @@ xmlSchemaGetCanonValueWhtspExt_1(xmlSchemaValPtr val,
 		       the same hash value for this to work, and it's easiest
 		       to just cut off the useless '.0' suffix for the
 		       decimal type.  */
-		    int len = xmlStrlen(value2);
-		    if (len > 2 && value2[len-1] == '0' && value2[len-2] == '.')
-		      ((xmlChar*)value2)[len-2] = 0;
+		    int len = xmlStrlen(value);
+		    if (len > 2 && value[len-1] == '0' && value[len-2] == '.') {
+			value2 = xmlStrndup(value, len - 2);
+			if (value2 == NULL)
+			    goto internal_error;
+			value = value2;
+		    }
 		}
-		value = value2;
 	}
 	if (*retValue == NULL)
 	    if (value == NULL) {
@@ -1854,7 +2119,10 @@ xmlSchemaPErrMemory(xmlSchemaParserCtxtPtr ctxt)
 
     if (ctxt != NULL) {
         ctxt->nberrors++;
-        ctxt->err = XML_ERR_NO_MEMORY;
+        if (xmlMemBudgetExceeded())
+            ctxt->err = XML_ERR_RESOURCE_LIMIT;
+        else
+            ctxt->err = XML_ERR_NO_MEMORY;
         channel = ctxt->error;
         schannel = ctxt->serror;
         data = ctxt->errCtxt;
@@ -1983,6 +2251,47 @@ xmlSchemaPErrExt(xmlSchemaParserCtxtPtr ctxt, xmlNodePtr node, int code,
  *									*
  ************************************************************************/
 
+#ifdef XML_SCHEMA_PARALLEL
+/*
+ * Structured error handler which appends errors to a segment of a
+ * parallel run.
+ */
+static void
+xmlSchemaParCollectError(void *data, const xmlError *error)
+{
+    xmlSchemaParSegmentPtr seg = (xmlSchemaParSegmentPtr) data;
+    xmlErrorPtr copy;
+
+    if (seg->nbErrors >= seg->sizeErrors) {
+        xmlErrorPtr tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(seg->sizeErrors, sizeof(tmp[0]),
+                                  4, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            seg->noMemory = 1;
+            return;
+        }
+        tmp = xmlRealloc(seg->errors, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            seg->noMemory = 1;
+            return;
+        }
+        seg->errors = tmp;
+        seg->sizeErrors = newSize;
+    }
+
+    copy = &seg->errors[seg->nbErrors];
+    memset(copy, 0, sizeof(*copy));
+    if (xmlCopyError(error, copy) < 0) {
+        xmlResetError(copy);
+        seg->noMemory = 1;
+        return;
+    }
+    seg->nbErrors++;
+}
+#endif /* XML_SCHEMA_PARALLEL */
+
 /**
  * Handle an out of memory condition
  *
@@ -1998,6 +2307,10 @@ xmlSchemaVErrMemory(xmlSchemaValidCtxtPtr ctxt)
     if (ctxt != NULL) {
         ctxt->nberrors++;
         ctxt->err = XML_ERR_NO_MEMORY;
+        if (ctxt->parSink != NULL) {
+            ctxt->parSink->noMemory = 1;
+            return;
+        }
         channel = ctxt->error;
         schannel = ctxt->serror;
         data = ctxt->errCtxt;
@@ -2006,6 +2319,33 @@ xmlSchemaVErrMemory(xmlSchemaValidCtxtPtr ctxt)
     xmlRaiseMemoryError(schannel, channel, data, XML_FROM_SCHEMASV, NULL);
 }
 
+/**
+ * Apply the error policy of a validation context and stop
+ * validation once the maximum number of errors was reached.
+ *
+ * @returns 1 if the error should be reported, 0 otherwise.
+ */
+static int
+xmlSchemaVErrPolicyCheck(xmlSchemaValidCtxtPtr ctxt, int code,
+                         xmlNodePtr node, xmlErrorLevel level)
+{
+    int report;
+
+    if ((ctxt->errorPolicy == NULL) || (code == XML_ERR_INTERNAL_ERROR))
+        return(1);
+
+    report = xmlErrorPolicyCheck(ctxt->errorPolicy, code,
+                                 node ? (int) node->type : 0, level);
+    if (ctxt->errorPolicy->stopped) {
+        /* Like failed XSI assembly, skip the rest of the document. */
+        ctxt->skipDepth = 0;
+        if (ctxt->parserCtxt != NULL)
+            xmlStopParser(ctxt->parserCtxt);
+    }
+
+    return(report);
+}
+
 static void LIBXML_ATTR_FORMAT(11,12)
 xmlSchemaVErrFull(xmlSchemaValidCtxtPtr ctxt, xmlNodePtr node, int code,
                   xmlErrorLevel level, const char *file, int line,
@@ -2031,8 +2371,19 @@ xmlSchemaVErrFull(xmlSchemaValidCtxtPtr ctxt, xmlNodePtr node, int code,
         }
         data = ctxt->errCtxt;
         schannel = ctxt->serror;
+#ifdef XML_SCHEMA_PARALLEL
+        if (ctxt->parSink != NULL) {
+            channel = NULL;
+            schannel = xmlSchemaParCollectError;
+            data = ctxt->parSink;
+        }
+#endif
     }
 
+    if ((ctxt != NULL) && (ctxt->parSink == NULL) &&
+        (!xmlSchemaVErrPolicyCheck(ctxt, code, node, level)))
+        return;
+
     if ((channel == NULL) && (schannel == NULL)) {
         channel = xmlGenericError;
         data = xmlGenericErrorContext;
@@ -2051,6 +2402,50 @@ xmlSchemaVErrFull(xmlSchemaValidCtxtPtr ctxt, xmlNodePtr node, int code,
         xmlSchemaVErrMemory(ctxt);
 }
 
+#ifdef XML_SCHEMA_PARALLEL
+/*
+ * Report an error collected during a parallel run. Errors were
+ * already counted by the context which raised them.
+ */
+static void
+xmlSchemaParReplayError(xmlSchemaValidCtxtPtr ctxt, const xmlError *error)
+{
+    xmlGenericErrorFunc channel;
+    xmlStructuredErrorFunc schannel;
+    void *data;
+    int res;
+
+    if (ctxt->err == XML_ERR_NO_MEMORY)
+        return;
+
+    if (error->level == XML_ERR_WARNING) {
+        channel = ctxt->warning;
+    } else {
+        ctxt->err = error->code;
+        channel = ctxt->error;
+    }
+    data = ctxt->errCtxt;
+    schannel = ctxt->serror;
+
+    if (!xmlSchemaVErrPolicyCheck(ctxt, error->code, error->node,
+                                  error->level))
+        return;
+
+    if ((channel == NULL) && (schannel == NULL)) {
+        channel = xmlGenericError;
+        data = xmlGenericErrorContext;
+    }
+
+    res = xmlRaiseError(schannel, channel, data, ctxt, error->node,
+                        error->domain, error->code, error->level,
+                        error->file, error->line, error->str1,
+                        error->str2, error->str3, error->int1, error->int2,
+                        "%s", error->message ? error->message : "");
+    if (res < 0)
+        xmlSchemaVErrMemory(ctxt);
+}
+#endif /* XML_SCHEMA_PARALLEL */
+
 #define WXS_ERROR_TYPE_ERROR 1
 #define WXS_ERROR_TYPE_WARNING 2
 /**
@@ -3585,6 +3980,7 @@ xmlSchemaBucketCreate(xmlSchemaParserCtxtPtr pctxt,
 		xmlSchemaBucketFree(ret);
 		return(NULL);
 	    }
+	    xmlHashIndexInterned(mainSchema->schemasImports);
 	}
 	if (targetNamespace == NULL)
 	    res = xmlHashAddEntry(mainSchema->schemasImports,
@@ -3758,6 +4154,9 @@ xmlSchemaFreeWildcard(xmlSchemaWildcard *wildcard)
 	xmlSchemaFreeWildcardNsSet(wildcard->nsSet);
     if (wildcard->negNsSet != NULL)
 	xmlFree(wildcard->negNsSet);
+    if (wildcard->nsIndex != NULL)
+	xmlSchemaFreeWildcardIndex(
+	    (xmlSchemaWildcardIndexPtr) wildcard->nsIndex);
     xmlFree(wildcard);
 }
 
@@ -3839,6 +4238,8 @@ xmlSchemaFreeIDC(xmlSchemaIDCPtr idcDef)
     if (idcDef->selector != NULL) {
 	if (idcDef->selector->xpathComp != NULL)
 	    xmlFreePattern((xmlPatternPtr) idcDef->selector->xpathComp);
+	if (idcDef->selector->nsArray != NULL)
+	    xmlFree((xmlChar **) idcDef->selector->nsArray);
 	xmlFree(idcDef->selector);
     }
     /* Fields */
@@ -3849,6 +4250,8 @@ xmlSchemaFreeIDC(xmlSchemaIDCPtr idcDef)
 	    cur = cur->next;
 	    if (prev->xpathComp != NULL)
 		xmlFreePattern((xmlPatternPtr) prev->xpathComp);
+	    if (prev->nsArray != NULL)
+		xmlFree((xmlChar **) prev->nsArray);
 	    xmlFree(prev);
 	} while (cur != NULL);
     }
@@ -3931,6 +4334,10 @@ xmlSchemaFreeType(xmlSchemaType *type)
     }
     if (type->contModel != NULL)
         xmlRegFreeRegexp(type->contModel);
+    if (type->allModel != NULL)
+        xmlSchemaFreeAllModel((xmlSchemaAllModelPtr) type->allModel);
+    if (type->enumIndex != NULL)
+        xmlSchemaFreeEnumIndex((xmlSchemaEnumIndexPtr) type->enumIndex);
     xmlFree(type);
 }
 
@@ -4034,6 +4441,16 @@ xmlSchemaComponentListFree(xmlSchemaItemListPtr list)
     }
 }
 
+static void
+xmlSchemaFreeLazyImports(xmlSchemaLazyImportsPtr lazy)
+{
+    xmlFree(lazy->items);
+    if (lazy->loaded != NULL)
+        xmlSchemaItemListFree(lazy->loaded);
+    xmlCleanupMutex(&lazy->lock);
+    xmlFree(lazy);
+}
+
 /**
  * Deallocate a Schema structure.
  *
@@ -4076,6 +4493,8 @@ xmlSchemaFree(xmlSchema *schema)
     }
     if (schema->annot != NULL)
         xmlSchemaFreeAnnot(schema->annot);
+    if (schema->lazyImports != NULL)
+        xmlSchemaFreeLazyImports(schema->lazyImports);
     /* Never free the doc here, since this will be done by the buckets. */
 
     xmlDictFree(schema->dict);
@@ -4570,7 +4989,7 @@ xmlSchemaGetProp(xmlSchemaParserCtxtPtr ctxt, xmlNodePtr node,
 
 #define WXS_FIND_GLOBAL_ITEM(slot)			\
     if (xmlStrEqual(nsName, schema->targetNamespace)) { \
-	ret = xmlHashLookup(schema->slot, name); \
+	ret = xmlHashLookupInterned(schema->slot, name); \
 	if (ret != NULL) goto exit; \
     } \
     if (xmlHashSize(schema->schemasImports) > 1) { \
@@ -4579,10 +4998,10 @@ xmlSchemaGetProp(xmlSchemaParserCtxtPtr ctxt, xmlNodePtr node,
 	    import = xmlHashLookup(schema->schemasImports, \
 		XML_SCHEMAS_NO_NAMESPACE); \
 	else \
-	    import = xmlHashLookup(schema->schemasImports, nsName); \
+	    import = xmlHashLookupInterned(schema->schemasImports, nsName); \
 	if (import == NULL) \
 	    goto exit; \
-	ret = xmlHashLookup(import->schema->slot, name); \
+	ret = xmlHashLookupInterned(import->schema->slot, name); \
     }
 
 /**
@@ -5471,6 +5890,7 @@ xmlSchemaSubstGroupAdd(xmlSchemaParserCtxtPtr pctxt,
 	WXS_SUBST_GROUPS(pctxt) = xmlHashCreateDict(10, pctxt->dict);
 	if (WXS_SUBST_GROUPS(pctxt) == NULL)
 	    return(NULL);
+	xmlHashIndexInterned(WXS_SUBST_GROUPS(pctxt));
     }
     /* Create a new substitution group. */
     ret = (xmlSchemaSubstGroupPtr) xmlMalloc(sizeof(xmlSchemaSubstGroup));
@@ -5503,7 +5923,7 @@ xmlSchemaSubstGroupGet(xmlSchemaParserCtxtPtr pctxt,
 {
     if (WXS_SUBST_GROUPS(pctxt) == NULL)
 	return(NULL);
-    return(xmlHashLookup2(WXS_SUBST_GROUPS(pctxt),
+    return(xmlHashLookupInterned2(WXS_SUBST_GROUPS(pctxt),
 	head->name, head->targetNamespace));
 
 }
@@ -5542,6 +5962,99 @@ xmlSchemaAddElementSubstitutionMember(xmlSchemaParserCtxtPtr pctxt,
  *									*
  ************************************************************************/
 
+static xmlSchemaLazyImportPtr
+xmlSchemaLazyImportGet(xmlSchemaLazyImportsPtr lazy, const xmlChar *nsName)
+{
+    int i;
+
+    for (i = 0; i < lazy->nbItems; i++) {
+        if (xmlStrEqual(lazy->items[i].nsName, nsName))
+            return(&lazy->items[i]);
+    }
+    return(NULL);
+}
+
+static xmlSchemaLazyImportPtr
+xmlSchemaLazyImportAdd(xmlSchemaLazyImportsPtr lazy, const xmlChar *nsName)
+{
+    xmlSchemaLazyImportPtr imp;
+
+    if (lazy->nbItems >= lazy->sizeItems) {
+        xmlSchemaLazyImportPtr tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(lazy->sizeItems, sizeof(tmp[0]),
+                                  8, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            xmlSchemaPErrMemory(NULL);
+            return(NULL);
+        }
+        tmp = xmlRealloc(lazy->items, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlSchemaPErrMemory(NULL);
+            return(NULL);
+        }
+        lazy->items = tmp;
+        lazy->sizeItems = newSize;
+    }
+    imp = &lazy->items[lazy->nbItems++];
+    memset(imp, 0, sizeof(*imp));
+    imp->nsName = nsName;
+    return(imp);
+}
+
+/*
+ * Mark the pending imports of a namespace as requested and return
+ * their number.
+ */
+static int
+xmlSchemaLazyImportMark(xmlSchemaLazyImportsPtr lazy, const xmlChar *nsName)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < lazy->nbItems; i++) {
+        if ((lazy->items[i].state == XML_SCHEMA_LAZY_PENDING) &&
+            (xmlStrEqual(lazy->items[i].nsName, nsName))) {
+            lazy->items[i].state = XML_SCHEMA_LAZY_REQUESTED;
+            ret++;
+        }
+    }
+    return(ret);
+}
+
+/**
+ * Request the import of a namespace referenced by a QName.
+ *
+ * @param pctxt  the schema parser context
+ * @param schema  the main schema
+ * @param nsName  the referenced namespace
+ * @returns 0 on success or -1 on memory errors.
+ */
+static int
+xmlSchemaLazyImportRequest(xmlSchemaParserCtxtPtr pctxt,
+                           xmlSchemaPtr schema,
+                           const xmlChar *nsName)
+{
+    xmlSchemaLazyImportsPtr lazy;
+    xmlSchemaLazyImportPtr imp;
+
+    if ((!pctxt->lazyImports) || (schema == NULL) ||
+        (schema->lazyImports == NULL) ||
+        (xmlStrEqual(nsName, xmlSchemaNs)))
+        return(0);
+    lazy = schema->lazyImports;
+
+    if ((xmlSchemaLazyImportMark(lazy, nsName) == 0) &&
+        (xmlSchemaLazyImportGet(lazy, nsName) == NULL)) {
+        /* Remember the request for a later <import>. */
+        imp = xmlSchemaLazyImportAdd(lazy, nsName);
+        if (imp == NULL)
+            return(-1);
+        imp->state = XML_SCHEMA_LAZY_REQUESTED;
+    }
+    return(0);
+}
+
 /**
  * Extracts the local name and the URI of a QName value and validates it.
  * This one is intended to be used on attribute values that
@@ -5598,7 +6111,7 @@ xmlSchemaPValAttrNodeQNameValue(xmlSchemaParserCtxtPtr ctxt,
 	    *uri = ctxt->targetNamespace;
 	}
 	*local = xmlDictLookup(ctxt->dict, value, -1);
-	return (0);
+	return (xmlSchemaLazyImportRequest(ctxt, schema, *uri));
     }
     /*
     * At this point xmlSplitQName3 has to return a local name.
@@ -5618,7 +6131,7 @@ xmlSchemaPValAttrNodeQNameValue(xmlSchemaParserCtxtPtr ctxt,
     } else {
         *uri = xmlDictLookup(ctxt->dict, ns->href, -1);
     }
-    return (0);
+    return (xmlSchemaLazyImportRequest(ctxt, schema, *uri));
 }
 
 /**
@@ -7807,9 +8320,24 @@ xmlSchemaCheckCSelectorXPath(xmlSchemaParserCtxtPtr ctxt,
 		xmlFree(nsList);
 		return (-1);
 	    }
+	    /*
+	    * The strings are kept in the dictionary so that the
+	    * expression can be compiled again when loading a saved
+	    * schema.
+	    */
 	    for (i = 0; i < count; i++) {
-		nsArray[2 * i] = nsList[i]->href;
-		nsArray[2 * i + 1] = nsList[i]->prefix;
+		nsArray[2 * i] = xmlDictLookup(ctxt->dict,
+		    nsList[i]->href, -1);
+		nsArray[2 * i + 1] = (nsList[i]->prefix == NULL) ? NULL :
+		    xmlDictLookup(ctxt->dict, nsList[i]->prefix, -1);
+		if ((nsArray[2 * i] == NULL) ||
+		    ((nsList[i]->prefix != NULL) &&
+		     (nsArray[2 * i + 1] == NULL))) {
+		    xmlSchemaPErrMemory(ctxt);
+		    xmlFree(nsArray);
+		    xmlFree(nsList);
+		    return (-1);
+		}
 	    }
 	    nsArray[count * 2] = NULL;
 	    xmlFree(nsList);
@@ -7823,8 +8351,7 @@ xmlSchemaCheckCSelectorXPath(xmlSchemaParserCtxtPtr ctxt,
 	else
 	    selector->xpathComp = (void *) xmlPatterncompile(selector->xpath,
 		NULL, XML_PATTERN_XSSEL, nsArray);
-	if (nsArray != NULL)
-	    xmlFree((xmlChar **) nsArray);
+	selector->nsArray = nsArray;
 
 	if (selector->xpathComp == NULL) {
 	    xmlSchemaPCustomErr(ctxt,
@@ -9627,6 +10154,11 @@ xmlSchemaRedefListFree(xmlSchemaRedefPtr redef)
     }
 }
 
+#ifdef XML_SCHEMA_PARALLEL
+static void
+xmlSchemaPrefetchFree(xmlSchemaPrefetchPtr pf);
+#endif
+
 static void
 xmlSchemaConstructionCtxtFree(xmlSchemaConstructionCtxtPtr con)
 {
@@ -9644,6 +10176,10 @@ xmlSchemaConstructionCtxtFree(xmlSchemaConstructionCtxtPtr con)
 	xmlHashFree(con->substGroups, xmlSchemaSubstGroupFreeEntry);
     if (con->redefs != NULL)
 	xmlSchemaRedefListFree(con->redefs);
+#ifdef XML_SCHEMA_PARALLEL
+    if (con->prefetch != NULL)
+        xmlSchemaPrefetchFree(con->prefetch);
+#endif
     if (con->dict != NULL)
 	xmlDictFree(con->dict);
     xmlFree(con);
@@ -9937,6 +10473,9 @@ xmlSchemaParseNewDoc(xmlSchemaParserCtxtPtr pctxt,
 	pctxt->errCtxt);
     xmlSchemaSetParserStructuredErrors(newpctxt, pctxt->serror,
 	pctxt->errCtxt);
+    newpctxt->resourceLoader = pctxt->resourceLoader;
+    newpctxt->resourceCtxt = pctxt->resourceCtxt;
+    newpctxt->lazyImports = pctxt->lazyImports;
     newpctxt->counter = pctxt->counter;
 
 
@@ -10002,70 +10541,340 @@ xmlSchemaBuildAbsoluteURI(xmlDictPtr dict, const xmlChar* location,
 
 
 
-/**
- * Parse an included (and to-be-redefined) XML schema document.
- *
- * @param pctxt  a schema validation context
- * @param type  import or include or redefine
- * @param schemaLocation  schema location
- * @param schemaDoc  schema document
- * @param schemaBuffer  document buffer
- * @param schemaBufferLen  buffer size
- * @param invokingNode  invoking node
- * @param sourceTargetNamespace  source target namespace
- * @param importNamespace  import namespace
- * @param bucket  bucket
- * @returns 0 on success, a positive error code on errors and
- *         -1 in case of an internal or API error.
- */
+#ifdef XML_SCHEMA_PARALLEL
+/*
+ * Schema documents referenced by <include>, <import> and <redefine>
+ * are fetched and parsed by worker threads as soon as the referencing
+ * document was loaded. The schema components are still built in
+ * document order by the calling thread which takes the parsed
+ * documents or waits for them.
+ */
+#define XML_SCHEMA_PREFETCH_QUEUED 0
+#define XML_SCHEMA_PREFETCH_RUNNING 1
+#define XML_SCHEMA_PREFETCH_DONE 2
+#define XML_SCHEMA_PREFETCH_TAKEN 3
+
+typedef struct {
+    const xmlChar *location;
+    xmlDocPtr doc;
+    int state;
+    int failed; /* the document must be parsed again for errors */
+} xmlSchemaPrefetchJob;
+
+struct _xmlSchemaPrefetch {
+    xmlSchemaPrefetchJob *jobs;
+    int nbJobs;
+    int sizeJobs;
+    int next; /* next job for the workers */
+    xmlTaskGroup *group;
+    int nbTasks; /* queued or running tasks */
+    int maxThreads;
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* new jobs or finished jobs */
+};
 
-static int
-xmlSchemaAddSchemaDoc(xmlSchemaParserCtxtPtr pctxt,
-		int type,
-		const xmlChar *schemaLocation,
-		xmlDocPtr schemaDoc,
-		const char *schemaBuffer,
-		int schemaBufferLen,
-		xmlNodePtr invokingNode,
-		const xmlChar *sourceTargetNamespace,
-		const xmlChar *importNamespace,
-		xmlSchemaBucketPtr *bucket)
+static xmlSchemaPrefetchPtr
+xmlSchemaPrefetchNew(int maxThreads)
 {
-    const xmlChar *targetNamespace = NULL;
-    xmlSchemaSchemaRelationPtr relation = NULL;
-    xmlDocPtr doc = NULL;
-    int res = 0, err = 0, located = 0, preserveDoc = 0;
-    xmlSchemaBucketPtr bkt = NULL;
-
-    if (bucket != NULL)
-	*bucket = NULL;
+    xmlSchemaPrefetchPtr pf;
 
-    switch (type) {
-	case XML_SCHEMA_SCHEMA_IMPORT:
-	case XML_SCHEMA_SCHEMA_MAIN:
-	    err = XML_SCHEMAP_SRC_IMPORT;
-	    break;
-	case XML_SCHEMA_SCHEMA_INCLUDE:
-	    err = XML_SCHEMAP_SRC_INCLUDE;
-	    break;
-	case XML_SCHEMA_SCHEMA_REDEFINE:
-	    err = XML_SCHEMAP_SRC_REDEFINE;
-	    break;
+    pf = xmlMalloc(sizeof(*pf));
+    if (pf == NULL) {
+        xmlSchemaPErrMemory(NULL);
+        return(NULL);
+    }
+    memset(pf, 0, sizeof(*pf));
+    pf->group = xmlNewTaskGroup();
+    if (pf->group == NULL) {
+        xmlSchemaPErrMemory(NULL);
+        xmlFree(pf);
+        return(NULL);
     }
+    pf->maxThreads = maxThreads;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->cond, NULL);
+    return(pf);
+}
 
+static void
+xmlSchemaPrefetchFree(xmlSchemaPrefetchPtr pf)
+{
+    int i;
 
-    /* Special handling for the main schema:
-    * skip the location and relation logic and just parse the doc.
-    * We need just a bucket to be returned in this case.
-    */
-    if ((type == XML_SCHEMA_SCHEMA_MAIN) || (! WXS_HAS_BUCKETS(pctxt)))
-	goto doc_load;
+    pthread_mutex_lock(&pf->lock);
+    pf->stop = 1;
+    pthread_mutex_unlock(&pf->lock);
+    xmlFreeTaskGroup(pf->group);
 
-    /* Note that we expect the location to be an absolute URI. */
-    if (schemaLocation != NULL) {
-	bkt = xmlSchemaGetSchemaBucket(pctxt, schemaLocation);
-	if ((bkt != NULL) &&
-	    (pctxt->constructor->bucket == bkt)) {
+    for (i = 0; i < pf->nbJobs; i++)
+        xmlFreeDoc(pf->jobs[i].doc);
+    xmlFree(pf->jobs);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->cond);
+    xmlFree(pf);
+}
+
+static void
+xmlSchemaPrefetchError(void *data, const xmlError *error ATTRIBUTE_UNUSED)
+{
+    *((int *) data) = 1;
+}
+
+/*
+ * Parse a schema document in a worker thread. Errors aren't
+ * reported here.
+ */
+static xmlDocPtr
+xmlSchemaPrefetchParse(const xmlChar *location, int *failed)
+{
+    xmlParserCtxtPtr ctxt;
+    xmlParserInputPtr input;
+    xmlDocPtr doc = NULL;
+
+    ctxt = xmlNewParserCtxt();
+    if (ctxt == NULL) {
+        *failed = 1;
+        return(NULL);
+    }
+    xmlCtxtSetErrorHandler(ctxt, xmlSchemaPrefetchError, failed);
+    xmlCtxtUseOptions(ctxt, SCHEMAS_PARSE_OPTIONS);
+    input = xmlLoadCachedResource(ctxt, (const char *) location, NULL,
+                                  XML_RESOURCE_MAIN_DOCUMENT);
+    if (input != NULL)
+        doc = xmlCtxtParseDocument(ctxt, input);
+    if (doc == NULL)
+        *failed = 1;
+    xmlFreeParserCtxt(ctxt);
+
+    return(doc);
+}
+
+/*
+ * Parse queued documents until there are no more jobs.
+ */
+static void
+xmlSchemaPrefetchWorker(void *data)
+{
+    xmlSchemaPrefetchPtr pf = data;
+    const xmlChar *location;
+    xmlDocPtr doc;
+    int i, failed;
+
+    pthread_mutex_lock(&pf->lock);
+    while ((pf->next < pf->nbJobs) && (!pf->stop)) {
+        i = pf->next++;
+        /* Jobs can be taken over by the calling thread. */
+        if (pf->jobs[i].state != XML_SCHEMA_PREFETCH_QUEUED)
+            continue;
+        pf->jobs[i].state = XML_SCHEMA_PREFETCH_RUNNING;
+        location = pf->jobs[i].location;
+        pthread_mutex_unlock(&pf->lock);
+
+        failed = 0;
+        doc = xmlSchemaPrefetchParse(location, &failed);
+
+        pthread_mutex_lock(&pf->lock);
+        pf->jobs[i].doc = doc;
+        pf->jobs[i].failed = failed;
+        pf->jobs[i].state = XML_SCHEMA_PREFETCH_DONE;
+        pthread_cond_broadcast(&pf->cond);
+    }
+    pf->nbTasks--;
+    pthread_mutex_unlock(&pf->lock);
+}
+
+static int
+xmlSchemaPrefetchAdd(xmlSchemaPrefetchPtr pf, const xmlChar *location)
+{
+    int i, ret = 0;
+    int submit = 0;
+
+    pthread_mutex_lock(&pf->lock);
+    for (i = 0; i < pf->nbJobs; i++) {
+        if (xmlStrEqual(pf->jobs[i].location, location))
+            goto done;
+    }
+    if (pf->nbJobs >= pf->sizeJobs) {
+        xmlSchemaPrefetchJob *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(pf->sizeJobs, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            ret = -1;
+            goto done;
+        }
+        tmp = xmlRealloc(pf->jobs, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            ret = -1;
+            goto done;
+        }
+        pf->jobs = tmp;
+        pf->sizeJobs = newSize;
+    }
+    memset(&pf->jobs[pf->nbJobs], 0, sizeof(pf->jobs[0]));
+    pf->jobs[pf->nbJobs++].location = location;
+
+    /* Start another task if all of them are busy. */
+    if (pf->nbTasks < pf->maxThreads) {
+        pf->nbTasks++;
+        submit = 1;
+    }
+
+done:
+    pthread_mutex_unlock(&pf->lock);
+
+    /* Executors may run the task right away. */
+    if ((submit) &&
+        (xmlTaskGroupSubmit(pf->group, xmlSchemaPrefetchWorker, pf) < 0)) {
+        pthread_mutex_lock(&pf->lock);
+        pf->nbTasks--;
+        pthread_mutex_unlock(&pf->lock);
+    }
+
+    return(ret);
+}
+
+/**
+ * Queue the schema documents referenced by a newly loaded one.
+ *
+ * @param pctxt  the schema parser context
+ * @param docElem  the <schema> element
+ */
+static void
+xmlSchemaPrefetchScan(xmlSchemaParserCtxtPtr pctxt, xmlNodePtr docElem)
+{
+    xmlSchemaPrefetchPtr pf = WXS_CONSTRUCTOR(pctxt)->prefetch;
+    const xmlChar *location;
+    xmlNodePtr child;
+
+    for (child = docElem->children; child != NULL; child = child->next) {
+        if (child->type != XML_ELEMENT_NODE)
+            continue;
+        if (IS_SCHEMA(child, "annotation"))
+            continue;
+        /* These must come before any other components. */
+        if ((!IS_SCHEMA(child, "include")) &&
+            (!IS_SCHEMA(child, "redefine")) &&
+            (!IS_SCHEMA(child, "import")))
+            break;
+        /* Lazy imports are loaded later if at all. */
+        if ((pctxt->lazyImports) && (IS_SCHEMA(child, "import")))
+            continue;
+
+        location = xmlSchemaGetProp(pctxt, child, "schemaLocation");
+        location = xmlSchemaBuildAbsoluteURI(pctxt->dict, location, child);
+        if ((location == NULL) ||
+            (xmlSchemaGetSchemaBucket(pctxt, location) != NULL))
+            continue;
+        if (xmlSchemaPrefetchAdd(pf, location) < 0)
+            break;
+    }
+}
+
+/**
+ * Take a document parsed by a worker thread. If the document is
+ * still queued, the calling thread parses it itself.
+ *
+ * @param pctxt  the schema parser context
+ * @param location  the absolute location of the document
+ * @returns the document or NULL if it wasn't parsed without errors.
+ */
+static xmlDocPtr
+xmlSchemaPrefetchTake(xmlSchemaParserCtxtPtr pctxt, const xmlChar *location)
+{
+    xmlSchemaPrefetchPtr pf = WXS_CONSTRUCTOR(pctxt)->prefetch;
+    xmlSchemaPrefetchJob *job;
+    xmlDocPtr doc = NULL;
+    int i;
+
+    pthread_mutex_lock(&pf->lock);
+    for (i = 0; i < pf->nbJobs; i++) {
+        if ((pf->jobs[i].state != XML_SCHEMA_PREFETCH_TAKEN) &&
+            (xmlStrEqual(pf->jobs[i].location, location)))
+            break;
+    }
+    if (i < pf->nbJobs) {
+        while (pf->jobs[i].state == XML_SCHEMA_PREFETCH_RUNNING)
+            pthread_cond_wait(&pf->cond, &pf->lock);
+        job = &pf->jobs[i];
+        if ((job->state == XML_SCHEMA_PREFETCH_DONE) && (!job->failed)) {
+            doc = job->doc;
+            job->doc = NULL;
+        }
+        job->state = XML_SCHEMA_PREFETCH_TAKEN;
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    return(doc);
+}
+#endif /* XML_SCHEMA_PARALLEL */
+
+/**
+ * Parse an included (and to-be-redefined) XML schema document.
+ *
+ * @param pctxt  a schema validation context
+ * @param type  import or include or redefine
+ * @param schemaLocation  schema location
+ * @param schemaDoc  schema document
+ * @param schemaBuffer  document buffer
+ * @param schemaBufferLen  buffer size
+ * @param invokingNode  invoking node
+ * @param sourceTargetNamespace  source target namespace
+ * @param importNamespace  import namespace
+ * @param bucket  bucket
+ * @returns 0 on success, a positive error code on errors and
+ *         -1 in case of an internal or API error.
+ */
+
+static int
+xmlSchemaAddSchemaDoc(xmlSchemaParserCtxtPtr pctxt,
+		int type,
+		const xmlChar *schemaLocation,
+		xmlDocPtr schemaDoc,
+		const char *schemaBuffer,
+		int schemaBufferLen,
+		xmlNodePtr invokingNode,
+		const xmlChar *sourceTargetNamespace,
+		const xmlChar *importNamespace,
+		xmlSchemaBucketPtr *bucket)
+{
+    const xmlChar *targetNamespace = NULL;
+    xmlSchemaSchemaRelationPtr relation = NULL;
+    xmlDocPtr doc = NULL;
+    int res = 0, err = 0, located = 0, preserveDoc = 0;
+    xmlSchemaBucketPtr bkt = NULL;
+
+    if (bucket != NULL)
+	*bucket = NULL;
+
+    switch (type) {
+	case XML_SCHEMA_SCHEMA_IMPORT:
+	case XML_SCHEMA_SCHEMA_MAIN:
+	    err = XML_SCHEMAP_SRC_IMPORT;
+	    break;
+	case XML_SCHEMA_SCHEMA_INCLUDE:
+	    err = XML_SCHEMAP_SRC_INCLUDE;
+	    break;
+	case XML_SCHEMA_SCHEMA_REDEFINE:
+	    err = XML_SCHEMAP_SRC_REDEFINE;
+	    break;
+    }
+
+
+    /* Special handling for the main schema:
+    * skip the location and relation logic and just parse the doc.
+    * We need just a bucket to be returned in this case.
+    */
+    if ((type == XML_SCHEMA_SCHEMA_MAIN) || (! WXS_HAS_BUCKETS(pctxt)))
+	goto doc_load;
+
+    /* Note that we expect the location to be an absolute URI. */
+    if (schemaLocation != NULL) {
+	bkt = xmlSchemaGetSchemaBucket(pctxt, schemaLocation);
+	if ((bkt != NULL) &&
+	    (pctxt->constructor->bucket == bkt)) {
 	    /* Report self-imports/inclusions/redefinitions. */
 
 	    xmlSchemaCustomErr(ACTXT_CAST pctxt, err,
@@ -10265,6 +11074,12 @@ doc_load:
 		schemaDoc->URL, -1);
         else
 	    schemaLocation = BAD_CAST "in_memory_buffer";
+#ifdef XML_SCHEMA_PARALLEL
+    } else if ((schemaLocation != NULL) &&
+               (WXS_CONSTRUCTOR(pctxt)->prefetch != NULL) &&
+               ((doc = xmlSchemaPrefetchTake(pctxt, schemaLocation)) != NULL)) {
+        /* Parsed by a worker thread. */
+#endif
     } else if ((schemaLocation != NULL) || (schemaBuffer != NULL)) {
 	xmlParserCtxtPtr parserCtxt;
 
@@ -10291,8 +11106,15 @@ doc_load:
 	}
 	if (schemaLocation != NULL) {
 	    /* Parse from file. */
-	    doc = xmlCtxtReadFile(parserCtxt, (const char *) schemaLocation,
-		NULL, SCHEMAS_PARSE_OPTIONS);
+	    xmlParserInputPtr input;
+
+	    /* Schema documents are often imported repeatedly */
+	    xmlCtxtUseOptions(parserCtxt, SCHEMAS_PARSE_OPTIONS);
+	    input = xmlLoadCachedResource(parserCtxt,
+		(const char *) schemaLocation, NULL,
+		XML_RESOURCE_MAIN_DOCUMENT);
+	    if (input != NULL)
+		doc = xmlCtxtParseDocument(parserCtxt, input);
 	} else if (schemaBuffer != NULL) {
 	    /* Parse from memory buffer. */
 	    doc = xmlCtxtReadMemory(parserCtxt, schemaBuffer, schemaBufferLen,
@@ -10376,6 +11198,10 @@ doc_load:
 		schemaLocation, NULL);
 	    goto exit_error;
 	}
+#ifdef XML_SCHEMA_PARALLEL
+        if (WXS_CONSTRUCTOR(pctxt)->prefetch != NULL)
+            xmlSchemaPrefetchScan(pctxt, docElem);
+#endif
 	/*
 	* Note that we don't apply a type check for the
 	* targetNamespace value here.
@@ -10437,6 +11263,120 @@ exit_failure:
     return (-1);
 }
 
+/**
+ * Defer the loading of an imported schema document until its
+ * namespace is referenced.
+ *
+ * @param pctxt  the schema parser context
+ * @param schema  the main schema
+ * @param node  the <import> element
+ * @param nsName  the imported namespace
+ * @param location  the absolute location of the schema document
+ * @param sourceNs  the target namespace of the importing schema
+ * @returns 1 if the import was deferred, 0 if it must be loaded now
+ * and -1 on memory errors.
+ */
+static int
+xmlSchemaLazyImportDefer(xmlSchemaParserCtxtPtr pctxt, xmlSchemaPtr schema,
+                         xmlNodePtr node, const xmlChar *nsName,
+                         const xmlChar *location, const xmlChar *sourceNs)
+{
+    xmlSchemaLazyImportsPtr lazy = schema->lazyImports;
+    xmlSchemaLazyImportPtr imp;
+    int i;
+
+    for (i = 0; i < lazy->nbItems; i++) {
+        imp = &lazy->items[i];
+        if (!xmlStrEqual(imp->nsName, nsName))
+            continue;
+        /* The namespace was already referenced. */
+        if (imp->state != XML_SCHEMA_LAZY_PENDING)
+            return(0);
+        if (imp->location == location)
+            return(1);
+    }
+    if (xmlSchemaGetSchemaBucketByTNS(pctxt, nsName, 1) != NULL)
+        return(0);
+
+    imp = xmlSchemaLazyImportAdd(lazy, nsName);
+    if (imp == NULL)
+        return(-1);
+    imp->location = location;
+    imp->sourceNs = sourceNs;
+    imp->owner = WXS_CONSTRUCTOR(pctxt)->bucket;
+    imp->node = node;
+    imp->state = XML_SCHEMA_LAZY_PENDING;
+    return(1);
+}
+
+/**
+ * Load the schema documents of all requested imports, including
+ * imports requested by the newly loaded documents.
+ *
+ * @param pctxt  the schema parser context
+ * @param schema  the main schema
+ * @returns 0 on success, a positive error code if a document is
+ * not valid and -1 in case of an internal error.
+ */
+static int
+xmlSchemaLazyImportLoadRequested(xmlSchemaParserCtxtPtr pctxt,
+                                 xmlSchemaPtr schema)
+{
+    xmlSchemaLazyImportsPtr lazy = schema->lazyImports;
+    xmlSchemaBucketPtr oldbucket = WXS_CONSTRUCTOR(pctxt)->bucket;
+    xmlSchemaBucketPtr bucket;
+    xmlSchemaLazyImport imp;
+    int i, ret;
+
+    for (i = 0; i < lazy->nbItems; i++) {
+        if ((lazy->items[i].state != XML_SCHEMA_LAZY_REQUESTED) ||
+            (lazy->items[i].location == NULL))
+            continue;
+        /* The items can be reallocated while parsing. */
+        lazy->items[i].state = XML_SCHEMA_LAZY_LOADED;
+        imp = lazy->items[i];
+        /*
+        * Like for other imports, further locations are only tried
+        * if a document couldn't be located.
+        */
+        bucket = xmlSchemaGetSchemaBucketByTNS(pctxt, imp.nsName, 1);
+        if (bucket != NULL) {
+            if (!xmlStrEqual(imp.location, bucket->schemaLocation))
+                xmlSchemaCustomWarning(ACTXT_CAST pctxt,
+                    XML_SCHEMAP_WARN_SKIP_SCHEMA,
+                    imp.node, NULL,
+                    "Skipping import of schema located at '%s' for the "
+                    "namespace '%s', since this namespace was already "
+                    "imported with the schema located at '%s'",
+                    imp.location, imp.nsName, bucket->schemaLocation);
+            continue;
+        }
+
+        bucket = NULL;
+        WXS_CONSTRUCTOR(pctxt)->bucket = imp.owner;
+        ret = xmlSchemaAddSchemaDoc(pctxt, XML_SCHEMA_SCHEMA_IMPORT,
+            imp.location, NULL, NULL, 0, imp.node, imp.sourceNs,
+            imp.nsName, &bucket);
+        if ((ret == 0) && (bucket == NULL)) {
+            xmlSchemaCustomWarning(ACTXT_CAST pctxt,
+                XML_SCHEMAP_WARN_UNLOCATED_SCHEMA,
+                imp.node, NULL,
+                "Failed to locate a schema at location '%s'. "
+                "Skipping the import", imp.location, NULL, NULL);
+        }
+        if ((ret == 0) && (bucket != NULL) && CAN_PARSE_SCHEMA(bucket))
+            ret = xmlSchemaParseNewDoc(pctxt, schema, bucket);
+        WXS_CONSTRUCTOR(pctxt)->bucket = oldbucket;
+        if (ret != 0)
+            return(ret);
+
+        /* Start over for imports requested by the new documents. */
+        i = -1;
+    }
+
+    return(0);
+}
+
 /**
  * parse a XML schema Import definition
  * *WARNING* this interface is highly subject to change
@@ -10565,6 +11505,16 @@ xmlSchemaParseImport(xmlSchemaParserCtxtPtr pctxt, xmlSchemaPtr schema,
     if (schemaLocation != NULL)
 	schemaLocation = xmlSchemaBuildAbsoluteURI(pctxt->dict,
 	    schemaLocation, node);
+    if ((schemaLocation != NULL) && (pctxt->lazyImports) &&
+        (schema->lazyImports != NULL)) {
+        ret = xmlSchemaLazyImportDefer(pctxt, schema, node, namespaceName,
+            schemaLocation, thisTargetNamespace);
+        if (ret < 0)
+            return(-1);
+        /* Only import the namespace for now. */
+        if (ret == 1)
+            schemaLocation = NULL;
+    }
     ret = xmlSchemaAddSchemaDoc(pctxt, XML_SCHEMA_SCHEMA_IMPORT,
 	schemaLocation, NULL, NULL, 0, node, thisTargetNamespace,
 	namespaceName, &bucket);
@@ -12157,71 +13107,585 @@ xmlSchemaParserCtxtGetOptions(xmlSchemaParserCtxtPtr ctxt)
 #endif
 
 /**
- * Create an XML Schemas parse context for that file/resource expected
- * to contain an XML Schemas file.
+ * Limit the memory a single validation run may hold. Allocations
+ * made during validation are charged to the context. If the budget
+ * is exceeded, validation fails with an XML_ERR_RESOURCE_LIMIT
+ * error.
  *
- * @param URL  the location of the schema
- * @returns the parser context or NULL in case of error
+ * Memory is only accounted with an allocator which records block
+ * sizes like #xmlPoolMalloc or #xmlMemMalloc.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param maxMem  maximum number of bytes or 0 for no limit
+ * @returns 0 on success or -1 if budgets aren't supported by the
+ * allocator or a memory allocation failed.
  */
-xmlSchemaParserCtxt *
-xmlSchemaNewParserCtxt(const char *URL)
+int
+xmlSchemaValidCtxtSetMaxMemory(xmlSchemaValidCtxt *ctxt, size_t maxMem)
 {
-    xmlSchemaParserCtxtPtr ret;
-
-    if (URL == NULL)
-        return (NULL);
-
-    ret = xmlSchemaParserCtxtCreate();
-    if (ret == NULL)
-	return(NULL);
-    ret->dict = xmlDictCreate();
-    ret->URL = xmlDictLookup(ret->dict, (const xmlChar *) URL, -1);
-    return (ret);
+    if (ctxt == NULL)
+        return(-1);
+    return(xmlMemBudgetSet(&ctxt->memBudget, maxMem));
 }
 
 /**
- * Create an XML Schemas parse context for that memory buffer expected
- * to contain an XML Schemas file.
+ * @since 2.16.0
  *
- * @param buffer  a pointer to a char array containing the schemas
- * @param size  the size of the array
- * @returns the parser context or NULL in case of error
+ * @param ctxt  a schema validation context
+ * @returns the number of bytes charged to the context's memory
+ * budget by the current or last validation run.
  */
-xmlSchemaParserCtxt *
-xmlSchemaNewMemParserCtxt(const char *buffer, int size)
+size_t
+xmlSchemaValidCtxtGetMemoryUsed(xmlSchemaValidCtxt *ctxt)
 {
-    xmlSchemaParserCtxtPtr ret;
-
-    if ((buffer == NULL) || (size <= 0))
-        return (NULL);
-    ret = xmlSchemaParserCtxtCreate();
-    if (ret == NULL)
-	return(NULL);
-    ret->buffer = buffer;
-    ret->size = size;
-    ret->dict = xmlDictCreate();
-    return (ret);
+    if ((ctxt == NULL) || (ctxt->memBudget == NULL))
+        return(0);
+    return(ctxt->memBudget->used);
 }
 
 /**
- * Create an XML Schemas parse context for that document.
- * NB. The document may be modified during the parsing process.
+ * Limit the errors reported by a validation context. Works like
+ * #xmlCtxtSetErrorPolicy. Once `maxErrors` errors were raised, the
+ * rest of the document isn't validated.
  *
- * @param doc  a preparsed document tree
- * @returns the parser context or NULL in case of error
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param maxErrors  maximum number of errors or 0 for no limit
+ * @param maxPerCode  maximum number of errors per code or 0 for no limit
+ * @param dedup  whether to report each code once per node type
+ * @returns 0 on success or -1 if an argument was invalid or a memory
+ * allocation failed.
  */
-xmlSchemaParserCtxt *
-xmlSchemaNewDocParserCtxt(xmlDoc *doc)
+int
+xmlSchemaValidCtxtSetErrorPolicy(xmlSchemaValidCtxt *ctxt, int maxErrors,
+                                 int maxPerCode, int dedup)
 {
-    xmlSchemaParserCtxtPtr ret;
+    if (ctxt == NULL)
+        return(-1);
+    return(xmlErrorPolicySet(&ctxt->errorPolicy, maxErrors, maxPerCode,
+                             dedup));
+}
 
-    if (doc == NULL)
-      return (NULL);
-    ret = xmlSchemaParserCtxtCreate();
-    if (ret == NULL)
-	return(NULL);
-    ret->doc = doc;
-    ret->dict = xmlDictCreate();
+/**
+ * Get the number of errors with a code raised by the current or last
+ * validation run, including errors which weren't reported because of
+ * the error policy. Only works if an error policy was set with
+ * #xmlSchemaValidCtxtSetErrorPolicy.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param code  the error code
+ * @param nodeType  node type, 0 for errors without node or -1 for all
+ * @returns the number of errors.
+ */
+int
+xmlSchemaValidCtxtGetErrorCount(xmlSchemaValidCtxt *ctxt, int code,
+                                int nodeType)
+{
+    if (ctxt == NULL)
+        return(0);
+    return(xmlErrorPolicyCount(ctxt->errorPolicy, code, nodeType));
+}
+
+/**
+ * Validate large subtrees of documents with multiple threads.
+ *
+ * Subtrees of at least `minNodes` elements are validated by worker
+ * threads if no identity-constraints of their ancestors are in
+ * scope. The calling thread validates the rest of the document.
+ * Errors are reported in document order once all threads are done,
+ * so error handlers are only invoked from the calling thread.
+ *
+ * The document must not be modified during validation. Duplicate
+ * xs:ID values in different subtrees are detected, but which of the
+ * elements is reported may vary. Validation of streams, with a
+ * memory limit or with XML_SCHEMA_VAL_VC_I_CREATE is always
+ * sequential.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param nbThreads  maximum number of threads or 0 to disable
+ * @param minNodes  minimum size of subtrees or 0 for the default
+ * @returns 0 on success or -1 if threads aren't supported.
+ */
+int
+xmlSchemaValidCtxtSetParallel(xmlSchemaValidCtxt *ctxt, int nbThreads,
+                              int minNodes)
+{
+    if (ctxt == NULL)
+        return(-1);
+
+    if (nbThreads <= 1) {
+        ctxt->parallelThreads = 0;
+        return(0);
+    }
+
+#ifdef XML_SCHEMA_PARALLEL
+    ctxt->parallelThreads = nbThreads;
+    ctxt->parallelMinNodes = (minNodes > 0) ?
+                             minNodes : XML_SCHEMA_PARALLEL_MIN_NODES;
+    return(0);
+#else
+    (void) minNodes;
+    return(-1);
+#endif
+}
+
+static void
+xmlSchemaFreeValidProfile(xmlSchemaValidProfilePtr prof)
+{
+    if (prof == NULL)
+        return;
+    xmlFree(prof->types);
+    xmlFree(prof->index);
+    xmlFree(prof);
+}
+
+/**
+ * Enable or disable profiling of a validation context. While enabled,
+ * the context counts validated elements and attributes per type and
+ * measures the CPU time spent checking simple type values, pushing
+ * content to automata, evaluating identity-constraints and
+ * processing wildcards. Enabling resets the counters, which then
+ * accumulate over all validation runs.
+ *
+ * Profiled contexts always validate sequentially.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param enable  1 to enable, 0 to disable
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+int
+xmlSchemaValidCtxtSetProfile(xmlSchemaValidCtxt *ctxt, int enable)
+{
+    if (ctxt == NULL)
+        return(-1);
+
+    xmlSchemaFreeValidProfile(ctxt->profile);
+    ctxt->profile = NULL;
+    if (enable) {
+        ctxt->profile = xmlMalloc(sizeof(*ctxt->profile));
+        if (ctxt->profile == NULL)
+            return(-1);
+        memset(ctxt->profile, 0, sizeof(*ctxt->profile));
+    }
+
+    return(0);
+}
+
+/**
+ * Get the totals collected by a profiled validation context, see
+ * #xmlSchemaValidCtxtSetProfile.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param stats  the struct to fill
+ * @returns 0 on success or -1 if profiling isn't enabled.
+ */
+int
+xmlSchemaValidCtxtGetStats(xmlSchemaValidCtxt *ctxt,
+                           xmlSchemaValidStats *stats)
+{
+    xmlSchemaValidProfilePtr prof;
+
+    if (stats == NULL)
+        return(-1);
+    memset(stats, 0, sizeof(*stats));
+    if ((ctxt == NULL) || (ctxt->profile == NULL))
+        return(-1);
+    prof = ctxt->profile;
+
+    stats->elements = prof->elements;
+    stats->attributes = prof->attributes;
+    stats->simpleChecks = prof->counts[XML_SCHEMA_PROF_SIMPLE];
+    stats->simpleTime = prof->times[XML_SCHEMA_PROF_SIMPLE];
+    stats->automatonPushes = prof->counts[XML_SCHEMA_PROF_AUTOMATON];
+    stats->automatonTime = prof->times[XML_SCHEMA_PROF_AUTOMATON];
+    stats->idcEvaluations = prof->counts[XML_SCHEMA_PROF_IDC];
+    stats->idcTime = prof->times[XML_SCHEMA_PROF_IDC];
+    stats->wildcards = prof->counts[XML_SCHEMA_PROF_WILDCARD];
+    stats->wildcardTime = prof->times[XML_SCHEMA_PROF_WILDCARD];
+
+    return(0);
+}
+
+static void
+xmlSchemaFreeKeptValues(xmlSchemaValidCtxtPtr vctxt)
+{
+    int i;
+
+    for (i = 0; i < vctxt->nbValues; i++)
+        xmlSchemaFreeValue(vctxt->values[i].value);
+    vctxt->nbValues = 0;
+}
+
+/*
+ * Hand the computed value of a node over to the list of kept values
+ * or free it.
+ */
+static void
+xmlSchemaKeepValue(xmlSchemaValidCtxtPtr vctxt, xmlNodePtr node,
+                   xmlSchemaValPtr val)
+{
+    if ((!vctxt->keepValues) || (node == NULL)) {
+        xmlSchemaFreeValue(val);
+        return;
+    }
+
+    if (vctxt->nbValues >= vctxt->sizeValues) {
+        xmlSchemaNodeValue *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(vctxt->sizeValues, sizeof(tmp[0]),
+                                  64, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            xmlSchemaFreeValue(val);
+            xmlSchemaVErrMemory(vctxt);
+            return;
+        }
+        tmp = xmlRealloc(vctxt->values, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlSchemaFreeValue(val);
+            xmlSchemaVErrMemory(vctxt);
+            return;
+        }
+        vctxt->values = tmp;
+        vctxt->sizeValues = newSize;
+    }
+
+    vctxt->values[vctxt->nbValues].node = node;
+    vctxt->values[vctxt->nbValues].value = val;
+    vctxt->nbValues++;
+}
+
+/**
+ * Keep the values computed for elements and attributes of simple
+ * type when validating a tree, so applications don't have to parse
+ * the lexical values a second time. The values can be retrieved
+ * with #xmlSchemaValidCtxtGetValues after validation and stay valid
+ * until the next validation run or until the context is freed.
+ *
+ * Computing values makes validation somewhat slower. Documents are
+ * always validated sequentially when values are kept.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param keep  whether to keep values
+ * @returns 0 on success or -1 in case of error.
+ */
+int
+xmlSchemaValidCtxtKeepValues(xmlSchemaValidCtxt *ctxt, int keep)
+{
+    if (ctxt == NULL)
+        return(-1);
+
+    ctxt->keepValues = keep ? 1 : 0;
+    return(0);
+}
+
+/**
+ * Get the values kept by the last validation run, see
+ * #xmlSchemaValidCtxtKeepValues. Values are listed in the order
+ * their nodes were completed. Canonical representations can be
+ * obtained with #xmlSchemaValueGetCanon.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param values  pointer to the array of values (output)
+ * @returns the number of values or -1 in case of error.
+ */
+int
+xmlSchemaValidCtxtGetValues(xmlSchemaValidCtxt *ctxt,
+                            const xmlSchemaNodeValue **values)
+{
+    if (values == NULL)
+        return(-1);
+    *values = NULL;
+    if (ctxt == NULL)
+        return(-1);
+
+    *values = ctxt->values;
+    return(ctxt->nbValues);
+}
+
+/*
+ * Get the counters of a type, creating them if necessary. Returns
+ * NULL if a memory allocation failed.
+ */
+static xmlSchemaTypeProfile *
+xmlSchemaProfileGetType(xmlSchemaValidCtxtPtr vctxt, xmlSchemaTypePtr type)
+{
+    xmlSchemaValidProfilePtr prof = vctxt->profile;
+    xmlSchemaTypeProfile *entry;
+    unsigned mask;
+    unsigned i;
+
+    if (prof->nbTypes * 2 >= prof->sizeIndex) {
+        int *index;
+        int newSize = prof->sizeIndex ? prof->sizeIndex * 2 : 64;
+        int k;
+
+        index = xmlMalloc(newSize * sizeof(index[0]));
+        if (index == NULL)
+            goto mem_error;
+        for (k = 0; k < newSize; k++)
+            index[k] = -1;
+        mask = newSize - 1;
+        for (k = 0; k < prof->nbTypes; k++) {
+            i = ((size_t) prof->types[k].type >> 4) * 2654435761u & mask;
+            while (index[i] >= 0)
+                i = (i + 1) & mask;
+            index[i] = k;
+        }
+        xmlFree(prof->index);
+        prof->index = index;
+        prof->sizeIndex = newSize;
+    }
+
+    mask = prof->sizeIndex - 1;
+    i = ((size_t) type >> 4) * 2654435761u & mask;
+    while (prof->index[i] >= 0) {
+        entry = &prof->types[prof->index[i]];
+        if (entry->type == type)
+            return(entry);
+        i = (i + 1) & mask;
+    }
+
+    if (prof->nbTypes >= prof->sizeTypes) {
+        xmlSchemaTypeProfile *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(prof->sizeTypes, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0)
+            goto mem_error;
+        tmp = xmlRealloc(prof->types, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto mem_error;
+        prof->types = tmp;
+        prof->sizeTypes = newSize;
+    }
+    entry = &prof->types[prof->nbTypes];
+    memset(entry, 0, sizeof(*entry));
+    entry->type = type;
+    prof->index[i] = prof->nbTypes++;
+
+    return(entry);
+
+mem_error:
+    xmlSchemaVErrMemory(vctxt);
+    return(NULL);
+}
+
+/*
+ * Count an element or attribute validated against a type.
+ */
+static void
+xmlSchemaProfileNode(xmlSchemaValidCtxtPtr vctxt, xmlSchemaTypePtr type,
+                     int isAttr)
+{
+    xmlSchemaTypeProfile *entry;
+
+    if (isAttr)
+        vctxt->profile->attributes += 1;
+    else
+        vctxt->profile->elements += 1;
+    if (type == NULL)
+        return;
+    entry = xmlSchemaProfileGetType(vctxt, type);
+    if (entry == NULL)
+        return;
+    if (isAttr)
+        entry->attributes += 1;
+    else
+        entry->elements += 1;
+}
+
+static clock_t
+xmlSchemaProfileStart(xmlSchemaValidCtxtPtr vctxt)
+{
+    return((vctxt->profile != NULL) ? clock() : 0);
+}
+
+/*
+ * Add the time since `start` and `count` operations to a category.
+ */
+static void
+xmlSchemaProfileEnd(xmlSchemaValidCtxtPtr vctxt,
+                    xmlSchemaProfCategory category, clock_t start,
+                    unsigned long count)
+{
+    xmlSchemaValidProfilePtr prof = vctxt->profile;
+
+    if (prof == NULL)
+        return;
+    prof->counts[category] += count;
+    prof->times[category] += (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+#ifdef LIBXML_DEBUG_ENABLED
+static int
+xmlSchemaCompareTypeProfiles(const void *a, const void *b)
+{
+    const xmlSchemaTypeProfile *pa = a;
+    const xmlSchemaTypeProfile *pb = b;
+
+    if (pa->time != pb->time)
+        return((pa->time < pb->time) ? 1 : -1);
+    if (pa->elements + pa->attributes != pb->elements + pb->attributes)
+        return((pa->elements + pa->attributes <
+                pb->elements + pb->attributes) ? 1 : -1);
+    return(0);
+}
+
+/**
+ * Print the counters collected by a profiled validation context,
+ * see #xmlSchemaValidCtxtSetProfile: the totals followed by the
+ * types used, sorted by the time spent checking their values.
+ * Times include nested work, for example facet checks of simple
+ * types or content model callbacks.
+ *
+ * @since 2.16.0
+ *
+ * @param output  the FILE * for the output
+ * @param ctxt  a schema validation context
+ */
+void
+xmlSchemaValidCtxtDumpProfile(FILE *output, xmlSchemaValidCtxt *ctxt)
+{
+    static const char *const names[XML_SCHEMA_PROF_MAX] = {
+        "simple type checks", "automaton pushes", "IDC evaluations",
+        "wildcards"
+    };
+    xmlSchemaValidProfilePtr prof;
+    xmlSchemaTypeProfile *types;
+    xmlChar *str = NULL;
+    int i;
+
+    if ((output == NULL) || (ctxt == NULL))
+        return;
+    prof = ctxt->profile;
+    if (prof == NULL) {
+        fprintf(output, "No profile\n");
+        return;
+    }
+
+    fprintf(output, "Elements: %lu, attributes: %lu\n",
+            prof->elements, prof->attributes);
+    for (i = 0; i < XML_SCHEMA_PROF_MAX; i++)
+        fprintf(output, "%s: %lu, %.3f ms\n", names[i], prof->counts[i],
+                prof->times[i] * 1000.0);
+
+    if (prof->nbTypes == 0)
+        return;
+    types = xmlMalloc(prof->nbTypes * sizeof(types[0]));
+    if (types == NULL)
+        return;
+    memcpy(types, prof->types, prof->nbTypes * sizeof(types[0]));
+    qsort(types, prof->nbTypes, sizeof(types[0]),
+          xmlSchemaCompareTypeProfiles);
+
+    fprintf(output, "Types:\n");
+    for (i = 0; i < prof->nbTypes; i++) {
+        xmlSchemaTypeProfile *entry = &types[i];
+
+        if (entry->type->builtInType == XML_SCHEMAS_ANYTYPE) {
+            fprintf(output, "  complex type 'xs:anyType'");
+        } else {
+            xmlSchemaFormatItemForReport(&str, NULL,
+                                         WXS_BASIC_CAST entry->type, NULL);
+            fprintf(output, "  %s", str ? (const char *) str : "(unknown)");
+        }
+        if ((!WXS_TYPE_IS_GLOBAL(entry->type)) &&
+            (entry->type->type != XML_SCHEMA_TYPE_BASIC) &&
+            (entry->type->node != NULL))
+            fprintf(output, " (line %ld)",
+                    xmlGetLineNo(entry->type->node));
+        fprintf(output, ": elements %lu, attributes %lu, checks %lu, "
+                "%.3f ms\n", entry->elements, entry->attributes,
+                entry->checks, entry->time * 1000.0);
+    }
+    xmlFree(str);
+    xmlFree(types);
+}
+#endif /* LIBXML_DEBUG_ENABLED */
+
+/**
+ * Create an XML Schemas parse context for that file/resource expected
+ * to contain an XML Schemas file.
+ *
+ * @param URL  the location of the schema
+ * @returns the parser context or NULL in case of error
+ */
+xmlSchemaParserCtxt *
+xmlSchemaNewParserCtxt(const char *URL)
+{
+    xmlSchemaParserCtxtPtr ret;
+
+    if (URL == NULL)
+        return (NULL);
+
+    ret = xmlSchemaParserCtxtCreate();
+    if (ret == NULL)
+	return(NULL);
+    ret->dict = xmlDictCreate();
+    ret->URL = xmlDictLookup(ret->dict, (const xmlChar *) URL, -1);
+    return (ret);
+}
+
+/**
+ * Create an XML Schemas parse context for that memory buffer expected
+ * to contain an XML Schemas file.
+ *
+ * @param buffer  a pointer to a char array containing the schemas
+ * @param size  the size of the array
+ * @returns the parser context or NULL in case of error
+ */
+xmlSchemaParserCtxt *
+xmlSchemaNewMemParserCtxt(const char *buffer, int size)
+{
+    xmlSchemaParserCtxtPtr ret;
+
+    if ((buffer == NULL) || (size <= 0))
+        return (NULL);
+    ret = xmlSchemaParserCtxtCreate();
+    if (ret == NULL)
+	return(NULL);
+    ret->buffer = buffer;
+    ret->size = size;
+    ret->dict = xmlDictCreate();
+    return (ret);
+}
+
+/**
+ * Create an XML Schemas parse context for that document.
+ * NB. The document may be modified during the parsing process.
+ *
+ * @param doc  a preparsed document tree
+ * @returns the parser context or NULL in case of error
+ */
+xmlSchemaParserCtxt *
+xmlSchemaNewDocParserCtxt(xmlDoc *doc)
+{
+    xmlSchemaParserCtxtPtr ret;
+
+    if (doc == NULL)
+      return (NULL);
+    ret = xmlSchemaParserCtxtCreate();
+    if (ret == NULL)
+	return(NULL);
+    ret->doc = doc;
+    ret->dict = xmlDictCreate();
     /* The application has responsibility for the document */
     ret->preserve = 1;
 
@@ -12839,6 +14303,97 @@ xmlSchemaBuildAContentModel(xmlSchemaParserCtxtPtr pctxt,
     return(ret);
 }
 
+static void
+xmlSchemaFreeAllModel(xmlSchemaAllModelPtr model)
+{
+    if (model == NULL)
+        return;
+    if (model->index != NULL)
+        xmlHashFree(model->index, NULL);
+    if (model->particles != NULL)
+        xmlFree(model->particles);
+    xmlFree(model);
+}
+
+/**
+ * Builds the bitset model of a complex type whose content model is
+ * an <all> model group. Types with substitution group heads are left
+ * to the automaton, since their particles match several names.
+ *
+ * @param type  the complex type definition
+ * @param ctxt  the schema parser context
+ */
+static void
+xmlSchemaBuildAllModel(xmlSchemaTypePtr type,
+		       xmlSchemaParserCtxtPtr ctxt)
+{
+    xmlSchemaParticlePtr particle = WXS_TYPE_PARTICLE(type);
+    xmlSchemaParticlePtr sub;
+    xmlSchemaElementPtr elemDecl;
+    xmlSchemaAllModelPtr model;
+    int nbParticles = 0, i;
+
+    if ((particle == NULL) || (particle->children == NULL) ||
+	(particle->children->type != XML_SCHEMA_TYPE_ALL))
+	return;
+
+    sub = (xmlSchemaParticlePtr) particle->children->children;
+    while (sub != NULL) {
+	elemDecl = (xmlSchemaElementPtr) sub->children;
+	if ((elemDecl == NULL) ||
+	    (elemDecl->flags & XML_SCHEMAS_ELEM_SUBST_GROUP_HEAD) ||
+	    (sub->maxOccurs != 1) ||
+	    ((sub->minOccurs != 0) && (sub->minOccurs != 1)))
+	    return;
+	nbParticles++;
+	sub = (xmlSchemaParticlePtr) sub->next;
+    }
+    if (nbParticles == 0)
+	return;
+
+    model = (xmlSchemaAllModelPtr) xmlMalloc(sizeof(xmlSchemaAllModel));
+    if (model == NULL) {
+	xmlSchemaPErrMemory(ctxt);
+	return;
+    }
+    memset(model, 0, sizeof(xmlSchemaAllModel));
+    model->optional = (particle->minOccurs == 0);
+    model->particles = (xmlSchemaAllParticlePtr)
+	xmlMalloc(nbParticles * sizeof(xmlSchemaAllParticle));
+    model->index = xmlHashCreate(nbParticles);
+    if ((model->particles == NULL) || (model->index == NULL)) {
+	xmlSchemaPErrMemory(ctxt);
+	xmlSchemaFreeAllModel(model);
+	return;
+    }
+
+    sub = (xmlSchemaParticlePtr) particle->children->children;
+    for (i = 0; i < nbParticles; i++) {
+	xmlSchemaAllParticlePtr item = &model->particles[i];
+	int res;
+
+	item->decl = (xmlSchemaElementPtr) sub->children;
+	item->required = (sub->minOccurs == 1);
+	/*
+	* Duplicate names make the model non-deterministic, which
+	* was already reported for the automaton.
+	*/
+	res = xmlHashAdd2(model->index, item->decl->name,
+			  item->decl->targetNamespace, item);
+	if (res <= 0) {
+	    if (res < 0)
+		xmlSchemaPErrMemory(ctxt);
+	    xmlSchemaFreeAllModel(model);
+	    return;
+	}
+	if (item->required)
+	    model->nbRequired++;
+	sub = (xmlSchemaParticlePtr) sub->next;
+    }
+    model->nbParticles = nbParticles;
+    type->allModel = model;
+}
+
 /**
  * Builds the content model of the complex type.
  *
@@ -12880,6 +14435,13 @@ xmlSchemaBuildContentModel(xmlSchemaTypePtr type,
 	    WXS_BASIC_CAST type, type->node,
 	    "The content model is not determinist", NULL);
     } else {
+        xmlSchemaBuildAllModel(type, ctxt);
+        /*
+        * Index the element names so that validation finds the
+        * transition of a child without comparing strings.
+        */
+        if (xmlRegexpBuildNameTable(type->contModel, ctxt->dict) < 0)
+            xmlSchemaPErrMemory(ctxt);
     }
     ctxt->state = NULL;
     xmlFreeAutomata(ctxt->am);
@@ -13759,7 +15321,14 @@ xmlSchemaCheckCVCWildcardNamespace(xmlSchemaWildcardPtr wild,
 
     if (wild->any)
 	return(0);
-    else if (wild->nsSet != NULL) {
+    else if (wild->nsIndex != NULL) {
+	xmlSchemaWildcardIndexPtr index =
+	    (xmlSchemaWildcardIndexPtr) wild->nsIndex;
+
+	if (ns == NULL)
+	    return(index->absent ? 0 : 1);
+	return(xmlHashLookup(index->table, ns) != NULL ? 0 : 1);
+    } else if (wild->nsSet != NULL) {
 	xmlSchemaWildcardNsPtr cur;
 
 	cur = wild->nsSet;
@@ -17528,6 +19097,199 @@ xmlSchemaTypeFixupOptimFacets(xmlSchemaTypePtr type)
     }
 }
 
+static void
+xmlSchemaFreeWildcardIndex(xmlSchemaWildcardIndexPtr index)
+{
+    if (index == NULL)
+        return;
+    xmlHashFree(index->table, NULL);
+    xmlFree(index);
+}
+
+/**
+ * Builds the hash table of the namespace set of a wildcard. Wildcards
+ * with few namespaces are left to a search of the set.
+ *
+ * @param wild  the wildcard (optional)
+ * @param ctxt  the schema parser context
+ */
+static void
+xmlSchemaBuildWildcardIndex(xmlSchemaWildcardPtr wild,
+			    xmlSchemaParserCtxtPtr ctxt)
+{
+    xmlSchemaWildcardIndexPtr index;
+    xmlSchemaWildcardNsPtr cur;
+    int nbNs = 0;
+
+    if ((wild == NULL) || (wild->nsIndex != NULL) || (wild->nsSet == NULL))
+	return;
+    for (cur = wild->nsSet; cur != NULL; cur = cur->next)
+	nbNs++;
+    if (nbNs < XML_SCHEMA_WILDCARD_INDEX_MIN)
+	return;
+
+    index = (xmlSchemaWildcardIndexPtr)
+	xmlMalloc(sizeof(xmlSchemaWildcardIndex));
+    if (index == NULL) {
+	xmlSchemaPErrMemory(ctxt);
+	return;
+    }
+    memset(index, 0, sizeof(xmlSchemaWildcardIndex));
+    index->table = xmlHashCreate(nbNs);
+    if (index->table == NULL) {
+	xmlSchemaPErrMemory(ctxt);
+	xmlSchemaFreeWildcardIndex(index);
+	return;
+    }
+    for (cur = wild->nsSet; cur != NULL; cur = cur->next) {
+	if (cur->value == NULL) {
+	    index->absent = 1;
+	} else if (xmlHashAdd(index->table, cur->value, wild) < 0) {
+	    xmlSchemaPErrMemory(ctxt);
+	    xmlSchemaFreeWildcardIndex(index);
+	    return;
+	}
+    }
+    wild->nsIndex = index;
+}
+
+static void
+xmlSchemaFreeEnumIndex(xmlSchemaEnumIndexPtr index)
+{
+    if (index == NULL)
+        return;
+    if (index->table != NULL)
+        xmlHashFree(index->table, NULL);
+    xmlFree(index->entries);
+    xmlFree(index->links);
+    xmlFree(index);
+}
+
+/**
+ * Builds the index of the enumeration facets of a simple type. Types
+ * with few enumerations or facet values without a hash string are
+ * left to a search of the facets.
+ *
+ * @param type  the simple type definition
+ * @param ctxt  the schema parser context
+ */
+static void
+xmlSchemaBuildEnumIndex(xmlSchemaTypePtr type,
+			xmlSchemaParserCtxtPtr ctxt)
+{
+    xmlSchemaEnumIndexPtr index;
+    xmlSchemaFacetLinkPtr link;
+    xmlSchemaFacetPtr facet;
+    xmlSchemaValPtr val;
+    xmlSchemaTypePtr prim;
+    int nbEnums = 0, nbLinks = 0, i = 0;
+
+    for (facet = type->facets; facet != NULL; facet = facet->next) {
+	const xmlChar *canon;
+
+	if (facet->type != XML_SCHEMA_FACET_ENUMERATION)
+	    continue;
+	if (facet->val == NULL)
+	    return;
+	/*
+	* Cache the canonical values now. Schemas are shared between
+	* threads, so they must not be computed during validation.
+	*/
+	for (val = facet->val; val != NULL; val = xmlSchemaValueGetNext(val))
+	    xmlSchemaValCanon(val, &canon);
+	nbEnums++;
+    }
+    if (nbEnums < XML_SCHEMA_ENUM_INDEX_MIN)
+	return;
+
+    index = (xmlSchemaEnumIndexPtr) xmlMalloc(sizeof(xmlSchemaEnumIndex));
+    if (index == NULL) {
+	xmlSchemaPErrMemory(ctxt);
+	return;
+    }
+    memset(index, 0, sizeof(xmlSchemaEnumIndex));
+    index->entries = (xmlSchemaEnumEntryPtr)
+	xmlMalloc(nbEnums * sizeof(xmlSchemaEnumEntry));
+    index->table = xmlHashCreate(nbEnums);
+    if ((index->entries == NULL) || (index->table == NULL)) {
+	xmlSchemaPErrMemory(ctxt);
+	xmlSchemaFreeEnumIndex(index);
+	return;
+    }
+
+    /*
+    * Copy the other facet links, so validation doesn't have to skip
+    * the enumerations.
+    */
+    for (link = type->facetSet; link != NULL; link = link->next) {
+	if (link->facet->type != XML_SCHEMA_FACET_ENUMERATION)
+	    nbLinks++;
+    }
+    if (nbLinks > 0) {
+	index->links = (xmlSchemaFacetLinkPtr)
+	    xmlMalloc(nbLinks * sizeof(xmlSchemaFacetLink));
+	if (index->links == NULL) {
+	    xmlSchemaPErrMemory(ctxt);
+	    xmlSchemaFreeEnumIndex(index);
+	    return;
+	}
+	for (link = type->facetSet; link != NULL; link = link->next) {
+	    if (link->facet->type == XML_SCHEMA_FACET_ENUMERATION)
+		continue;
+	    index->links[i].facet = link->facet;
+	    index->links[i].next = (i + 1 < nbLinks) ?
+		&index->links[i + 1] : NULL;
+	    i++;
+	}
+	i = 0;
+    }
+
+    /*
+    * Equal strings and decimals have equal hash strings. Other types
+    * like dates or durations compare equal in different forms.
+    */
+    index->exact = 1;
+    for (facet = type->facets; facet != NULL; facet = facet->next) {
+	xmlSchemaEnumEntryPtr entry, head;
+	xmlChar *value = NULL;
+	int res;
+
+	if (facet->type != XML_SCHEMA_FACET_ENUMERATION)
+	    continue;
+	for (val = facet->val; val != NULL; val = xmlSchemaValueGetNext(val)) {
+	    prim = xmlSchemaGetPrimitiveType(
+		xmlSchemaGetBuiltInType(xmlSchemaGetValType(val)));
+	    if ((prim == NULL) ||
+		((prim->builtInType != XML_SCHEMAS_STRING) &&
+		 (prim->builtInType != XML_SCHEMAS_DECIMAL) &&
+		 (! WXS_IS_ANY_SIMPLE_TYPE(prim))))
+		index->exact = 0;
+	}
+	if (xmlSchemaGetCanonValueHash(facet->val, &value) < 0) {
+	    xmlSchemaFreeEnumIndex(index);
+	    return;
+	}
+	entry = &index->entries[i++];
+	entry->facet = facet;
+	head = xmlHashLookup(index->table, value);
+	if (head != NULL) {
+	    entry->next = head->next;
+	    head->next = entry;
+	    res = 0;
+	} else {
+	    entry->next = NULL;
+	    res = xmlHashAddEntry(index->table, value, entry);
+	}
+	xmlFree(value);
+	if (res < 0) {
+	    xmlSchemaPErrMemory(ctxt);
+	    xmlSchemaFreeEnumIndex(index);
+	    return;
+	}
+    }
+    type->enumIndex = index;
+}
+
 static int
 xmlSchemaTypeFixupWhitespace(xmlSchemaTypePtr type)
 {
@@ -17744,6 +19506,7 @@ xmlSchemaFixupSimpleTypeStageTwo(xmlSchemaParserCtxtPtr pctxt,
     res = xmlSchemaTypeFixupWhitespace(type);
     HFAILURE HERROR
     xmlSchemaTypeFixupOptimFacets(type);
+    xmlSchemaBuildEnumIndex(type, pctxt);
 
 exit_error:
     if (olderrs != pctxt->nberrors)
@@ -20354,6 +22117,7 @@ xmlSchemaAddComponents(xmlSchemaParserCtxtPtr pctxt,
 		    "failed to create a component hash table");
 		return(-1);
 	    }
+	    xmlHashIndexInterned(*table);
 	}
 	err = xmlHashAddEntry(*table, name, item);
 	if (err != 0) {
@@ -20811,6 +22575,8 @@ xmlSchemaFixupComponents(xmlSchemaParserCtxtPtr pctxt,
 	    case XML_SCHEMA_TYPE_COMPLEX:
 		xmlSchemaBuildContentModel((xmlSchemaTypePtr) item, pctxt);
 		/* FIXHFAILURE; */
+		xmlSchemaBuildWildcardIndex(
+		    ((xmlSchemaTypePtr) item)->attributeWildcard, pctxt);
 		break;
 	    default:
 		break;
@@ -20848,16 +22614,11 @@ exit:
     }
     return(ret);
 }
-/**
- * parse a schema definition resource and build an internal
- * XML Schema structure which can be used to validate instances.
- *
- * @param ctxt  a schema validation context
- * @returns the internal XML Schema structure built from the resource or
- *         NULL in case of error
+/*
+ * Parses the main schema, xmlSchemaParse adds tracing around it.
  */
-xmlSchema *
-xmlSchemaParse(xmlSchemaParserCtxt *ctxt)
+static xmlSchemaPtr
+xmlSchemaParseInternal(xmlSchemaParserCtxtPtr ctxt)
 {
     xmlSchemaPtr mainSchema = NULL;
     xmlSchemaBucketPtr bucket = NULL;
@@ -20883,6 +22644,20 @@ xmlSchemaParse(xmlSchemaParserCtxt *ctxt)
     mainSchema = xmlSchemaNewSchema(ctxt);
     if (mainSchema == NULL)
 	goto exit_failure;
+    if (ctxt->lazyImports) {
+        xmlSchemaLazyImportsPtr lazy;
+
+        lazy = xmlMalloc(sizeof(*lazy));
+        if (lazy == NULL) {
+            xmlSchemaPErrMemory(ctxt);
+            goto exit_failure;
+        }
+        memset(lazy, 0, sizeof(*lazy));
+        lazy->resourceLoader = ctxt->resourceLoader;
+        lazy->resourceCtxt = ctxt->resourceCtxt;
+        xmlInitMutex(&lazy->lock);
+        mainSchema->lazyImports = lazy;
+    }
     /*
     * Create the schema constructor.
     */
@@ -20892,6 +22667,14 @@ xmlSchemaParse(xmlSchemaParserCtxt *ctxt)
 	    goto exit_failure;
 	/* Take ownership of the constructor to be able to free it. */
 	ctxt->ownsConstructor = 1;
+#ifdef XML_SCHEMA_PARALLEL
+        if ((ctxt->parseThreads > 1) && (ctxt->resourceLoader == NULL)) {
+            ctxt->constructor->prefetch =
+                xmlSchemaPrefetchNew(ctxt->parseThreads - 1);
+            if (ctxt->constructor->prefetch == NULL)
+                goto exit_failure;
+        }
+#endif
     }
     ctxt->constructor->mainSchema = mainSchema;
     /*
@@ -20922,6 +22705,9 @@ xmlSchemaParse(xmlSchemaParserCtxt *ctxt)
     /* Then do the parsing for good. */
     if (xmlSchemaParseNewDocWithContext(ctxt, mainSchema, bucket) == -1)
 	goto exit_failure;
+    if ((ctxt->nberrors == 0) && (mainSchema->lazyImports != NULL) &&
+        (xmlSchemaLazyImportLoadRequested(ctxt, mainSchema) == -1))
+        goto exit_failure;
     if (ctxt->nberrors != 0)
 	goto exit;
 
@@ -20933,11 +22719,35 @@ xmlSchemaParse(xmlSchemaParserCtxt *ctxt)
     if (xmlSchemaFixupComponents(ctxt, WXS_CONSTRUCTOR(ctxt)->mainBucket) == -1)
 	goto exit_failure;
 
+    if (mainSchema->lazyImports != NULL) {
+        xmlSchemaLazyImportsPtr lazy = mainSchema->lazyImports;
+        int i;
+
+        for (i = 0; i < lazy->nbItems; i++) {
+            if ((lazy->items[i].state == XML_SCHEMA_LAZY_PENDING) &&
+                (lazy->items[i].location != NULL))
+                break;
+        }
+        /* Nothing left to load during validation. */
+        if (i >= lazy->nbItems) {
+            xmlSchemaFreeLazyImports(lazy);
+            mainSchema->lazyImports = NULL;
+        }
+    }
+
     /*
     * TODO: This is not nice, since we cannot distinguish from the
     * result if there was an internal error or not.
     */
 exit:
+#ifdef XML_SCHEMA_PARALLEL
+    /* Stop the workers and free unused documents. */
+    if ((ctxt->constructor != NULL) &&
+        (ctxt->constructor->prefetch != NULL)) {
+        xmlSchemaPrefetchFree(ctxt->constructor->prefetch);
+        ctxt->constructor->prefetch = NULL;
+    }
+#endif
     if (ctxt->nberrors != 0) {
 	if (mainSchema) {
 	    xmlSchemaFree(mainSchema);
@@ -20971,6 +22781,38 @@ exit_failure:
     return(NULL);
 }
 
+/**
+ * parse a schema definition resource and build an internal
+ * XML Schema structure which can be used to validate instances.
+ *
+ * The returned schema is immutable. It can be shared by validation
+ * contexts in multiple threads until it is freed.
+ *
+ * @param ctxt  a schema validation context
+ * @returns the internal XML Schema structure built from the resource or
+ *         NULL in case of error
+ */
+xmlSchema *
+xmlSchemaParse(xmlSchemaParserCtxt *ctxt)
+{
+    xmlSchemaPtr ret;
+    const char *url = NULL;
+    double start;
+
+    if (ctxt != NULL)
+        url = (const char *) ctxt->URL;
+    XML_TRACE_BEGIN(schema_load, 0, url, start);
+
+    ret = xmlSchemaParseInternal(ctxt);
+
+    XML_TRACE_END(schema_load, XML_TRACE_SCHEMA_LOAD, url,
+                  ((ctxt != NULL) && (ctxt->buffer != NULL)) ?
+                  (long) ctxt->size : -1,
+                  start);
+
+    return(ret);
+}
+
 /**
  * Set the callback functions used to handle errors for a validation context
  *
@@ -21016,46 +22858,1317 @@ xmlSchemaSetParserStructuredErrors(xmlSchemaParserCtxt *ctxt,
 }
 
 /**
- * Get the callback information used to handle errors for a parser context
+ * Get the callback information used to handle errors for a parser context
+ *
+ * @param ctxt  a XMl-Schema parser context
+ * @param err  the error callback result
+ * @param warn  the warning callback result
+ * @param ctx  contextual data for the callbacks result
+ * @returns -1 in case of failure, 0 otherwise
+ */
+int
+xmlSchemaGetParserErrors(xmlSchemaParserCtxt *ctxt,
+			 xmlSchemaValidityErrorFunc * err,
+			 xmlSchemaValidityWarningFunc * warn, void **ctx)
+{
+	if (ctxt == NULL)
+		return(-1);
+	if (err != NULL)
+		*err = ctxt->error;
+	if (warn != NULL)
+		*warn = ctxt->warning;
+	if (ctx != NULL)
+		*ctx = ctxt->errCtxt;
+	return(0);
+}
+
+/**
+ * Register a callback function that will be called to load documents
+ * or external entities.
+ *
+ * @since 2.14.0
+ * @param ctxt  schema parser
+ * @param loader  resource loader
+ * @param data  user data which will be passed to the loader
+ */
+void
+xmlSchemaSetResourceLoader(xmlSchemaParserCtxt *ctxt,
+                           xmlResourceLoader loader, void *data) {
+    if (ctxt == NULL)
+        return;
+    ctxt->resourceLoader = loader;
+    ctxt->resourceCtxt = data;
+}
+
+/**
+ * Enable or disable lazy loading of imported schema documents.
+ *
+ * With lazy loading, the schema document of an `<xs:import>` is only
+ * loaded when the schema references a component in its namespace.
+ * The other imports are loaded when an instance uses their namespace
+ * during validation, for example in wildcards, as document element
+ * or with xsi:type. Loading takes a lock, so the schema can still be
+ * shared between threads.
+ *
+ * Errors in schema documents loaded during validation are reported
+ * by the validation which loaded them. Elements in namespaces which
+ * weren't loaded when the schema was parsed can't be members of
+ * substitution groups from other namespaces.
+ *
+ * @since 2.16.0
+ * @param ctxt  schema parser
+ * @param lazy  whether to load imports lazily
+ * @returns 0 on success or -1 if `ctxt` is NULL.
+ */
+int
+xmlSchemaSetParserLazyImports(xmlSchemaParserCtxt *ctxt, int lazy) {
+    if (ctxt == NULL)
+        return(-1);
+    ctxt->lazyImports = (lazy != 0);
+    return(0);
+}
+
+/**
+ * Fetch and parse included, imported and redefined schema documents
+ * with multiple threads.
+ *
+ * Worker threads parse the schema documents referenced by a schema
+ * document as soon as it was loaded, while the calling thread builds
+ * the schema components. Documents with parser errors or warnings are
+ * parsed again by the calling thread, so all errors are reported from
+ * the calling thread. Threads aren't used if a resource loader was
+ * set with #xmlSchemaSetResourceLoader.
+ *
+ * @since 2.16.0
+ * @param ctxt  schema parser
+ * @param nbThreads  maximum number of threads or 0 to disable
+ * @returns 0 on success or -1 if threads aren't supported.
+ */
+int
+xmlSchemaSetParserThreads(xmlSchemaParserCtxt *ctxt, int nbThreads) {
+    if (ctxt == NULL)
+        return(-1);
+
+    if (nbThreads <= 1) {
+        ctxt->parseThreads = 0;
+        return(0);
+    }
+
+#ifdef XML_SCHEMA_PARALLEL
+    ctxt->parseThreads = nbThreads;
+    return(0);
+#else
+    return(-1);
+#endif
+}
+
+/************************************************************************
+ *									*
+ *			Binary serialization				*
+ *									*
+ ************************************************************************/
+
+/*
+ * A compiled schema is saved as a graph of components. Components
+ * get ids in the order they are first referenced and references are
+ * written as ids: 0 for NULL and negative ids for the objects of the
+ * built-in types, which aren't saved. Strings are written as indices
+ * into a table of unique strings. The layout is
+ *
+ *   magic, format version, number of built-in objects
+ *   the string table
+ *   the kinds of the components, so they can be allocated up front
+ *   the main schema, the buckets and the imported schemas
+ *   the fields of the components in the order of their ids
+ *
+ * The fields are read and written by the same functions, so both
+ * directions can't drift apart.
+ */
+
+#define XML_SCHEMA_BIN_MAGIC "LXSB"
+#define XML_SCHEMA_BIN_VERSION 1
+
+#define XML_SCHEMA_BIN_IS_FACET(t) \
+    (((t) >= XML_SCHEMA_FACET_MININCLUSIVE) && \
+     ((t) <= XML_SCHEMA_FACET_MINLENGTH))
+
+typedef struct _xmlSchemaBinEntry xmlSchemaBinEntry;
+typedef xmlSchemaBinEntry *xmlSchemaBinEntryPtr;
+struct _xmlSchemaBinEntry {
+    const void *ptr;
+    int id;
+};
+
+typedef struct _xmlSchemaBinCtxt xmlSchemaBinCtxt;
+typedef xmlSchemaBinCtxt *xmlSchemaBinCtxtPtr;
+struct _xmlSchemaBinCtxt {
+    int load; /* whether the schema is read or written */
+    int error; /* errors when writing, see reader.error otherwise */
+    xmlSchemaItemListPtr items; /* the components by id */
+    xmlSchemaItemListPtr builtins; /* the built-in objects by -id */
+    /* Writing */
+    xmlBuf *buf;
+    xmlSchemaBinEntryPtr map; /* the ids of the known objects */
+    int mapSize;
+    int nbMap;
+    xmlHashTablePtr strIndex; /* string -> index + 1 */
+    xmlSchemaItemListPtr strings;
+    /* Reading */
+    xmlBinReader reader;
+    xmlDictPtr dict;
+    const xmlChar **strTable;
+    int nbStrTable;
+    xmlSchemaItemListPtr locals; /* components until the main bucket owns them */
+};
+
+static int
+xmlSchemaBinMapIndex(xmlSchemaBinCtxtPtr ctxt, const void *ptr)
+{
+    size_t v = (size_t) ptr;
+    unsigned int i;
+
+    i = (unsigned int) ((v >> 4) ^ (v >> 20)) * 2654435761u;
+    i = (i ^ (i >> 16)) & (ctxt->mapSize - 1);
+    while ((ctxt->map[i].ptr != NULL) && (ctxt->map[i].ptr != ptr))
+	i = (i + 1) & (ctxt->mapSize - 1);
+    return(i);
+}
+
+static int
+xmlSchemaBinMapGet(xmlSchemaBinCtxtPtr ctxt, const void *ptr)
+{
+    if (ctxt->map == NULL)
+	return(0);
+    return(ctxt->map[xmlSchemaBinMapIndex(ctxt, ptr)].id);
+}
+
+static int
+xmlSchemaBinMapPut(xmlSchemaBinCtxtPtr ctxt, const void *ptr, int id)
+{
+    int i;
+
+    if (ctxt->nbMap * 2 >= ctxt->mapSize) {
+	xmlSchemaBinEntryPtr old = ctxt->map;
+	int oldSize = ctxt->mapSize;
+	int newSize = (oldSize > 0) ? oldSize * 2 : 256;
+
+	if (oldSize > XML_MAX_ITEMS) {
+	    xmlSchemaPErrMemory(NULL);
+	    return(-1);
+	}
+	ctxt->map = xmlMalloc(newSize * sizeof(xmlSchemaBinEntry));
+	if (ctxt->map == NULL) {
+	    xmlSchemaPErrMemory(NULL);
+	    ctxt->map = old;
+	    return(-1);
+	}
+	memset(ctxt->map, 0, newSize * sizeof(xmlSchemaBinEntry));
+	ctxt->mapSize = newSize;
+	for (i = 0; i < oldSize; i++) {
+	    if (old[i].ptr != NULL)
+		ctxt->map[xmlSchemaBinMapIndex(ctxt, old[i].ptr)] = old[i];
+	}
+	xmlFree(old);
+    }
+    i = xmlSchemaBinMapIndex(ctxt, ptr);
+    if (ctxt->map[i].ptr == NULL) {
+	ctxt->map[i].ptr = ptr;
+	ctxt->map[i].id = id;
+	ctxt->nbMap++;
+    }
+    return(0);
+}
+
+static int
+xmlSchemaBinInt(xmlSchemaBinCtxtPtr ctxt, int val)
+{
+    if (ctxt->load)
+	return(xmlBinReadInt(&ctxt->reader));
+    xmlBinWriteInt(ctxt->buf, val);
+    return(val);
+}
+
+/*
+ * Every counted item takes at least four bytes, which bounds the
+ * counts of valid input.
+ */
+static int
+xmlSchemaBinCount(xmlSchemaBinCtxtPtr ctxt, int val)
+{
+    if (! ctxt->load) {
+	xmlBinWriteInt(ctxt->buf, val);
+	return(val);
+    }
+    val = xmlBinReadInt(&ctxt->reader);
+    if ((val < 0) || (val > (ctxt->reader.end - ctxt->reader.cur) / 4)) {
+	ctxt->reader.error = 1;
+	return(0);
+    }
+    return(val);
+}
+
+static const xmlChar *
+xmlSchemaBinStr(xmlSchemaBinCtxtPtr ctxt, const xmlChar *str)
+{
+    int idx = 0;
+
+    if (ctxt->load) {
+	idx = xmlBinReadInt(&ctxt->reader);
+	if ((idx < 0) || (idx > ctxt->nbStrTable)) {
+	    ctxt->reader.error = 1;
+	    return(NULL);
+	}
+	return((idx == 0) ? NULL : ctxt->strTable[idx - 1]);
+    }
+    if (str != NULL) {
+	idx = XML_PTR_TO_INT(xmlHashLookup(ctxt->strIndex, str));
+	if (idx == 0) {
+	    if ((xmlSchemaItemListAdd(ctxt->strings, (void *) str) < 0) ||
+		(xmlHashAddEntry(ctxt->strIndex, str,
+		    XML_INT_TO_PTR(ctxt->strings->nbItems)) < 0)) {
+		ctxt->error = 1;
+		return(str);
+	    }
+	    idx = ctxt->strings->nbItems;
+	}
+    }
+    xmlBinWriteInt(ctxt->buf, idx);
+    return(str);
+}
+
+static void *
+xmlSchemaBinRef(xmlSchemaBinCtxtPtr ctxt, void *ref)
+{
+    int id = 0;
+
+    if (ctxt->load) {
+	id = xmlBinReadInt(&ctxt->reader);
+	if ((id > 0) && (id <= ctxt->items->nbItems))
+	    return(ctxt->items->items[id - 1]);
+	if ((id < 0) && (id >= -ctxt->builtins->nbItems))
+	    return(ctxt->builtins->items[-id - 1]);
+	if (id != 0)
+	    ctxt->reader.error = 1;
+	return(NULL);
+    }
+    if (ref != NULL) {
+	id = xmlSchemaBinMapGet(ctxt, ref);
+	if (id == 0) {
+	    /* Queue the component, its fields are written later. */
+	    if ((xmlSchemaItemListAdd(ctxt->items, ref) < 0) ||
+		(xmlSchemaBinMapPut(ctxt, ref, ctxt->items->nbItems) < 0)) {
+		ctxt->error = 1;
+		return(ref);
+	    }
+	    id = ctxt->items->nbItems;
+	}
+    }
+    xmlBinWriteInt(ctxt->buf, id);
+    return(ref);
+}
+
+static void
+xmlSchemaBinSaveData(void *ctxt, xmlBuf *buf ATTRIBUTE_UNUSED, void *data)
+{
+    xmlSchemaBinRef((xmlSchemaBinCtxtPtr) ctxt, data);
+}
+
+static void *
+xmlSchemaBinLoadData(void *ctxt, xmlBinReader *reader ATTRIBUTE_UNUSED)
+{
+    return(xmlSchemaBinRef((xmlSchemaBinCtxtPtr) ctxt, NULL));
+}
+
+static xmlRegexpPtr
+xmlSchemaBinRegexp(xmlSchemaBinCtxtPtr ctxt, xmlRegexpPtr regexp)
+{
+    if (! xmlSchemaBinInt(ctxt, regexp != NULL))
+	return(NULL);
+    if (ctxt->load)
+	return(xmlRegexpLoad(&ctxt->reader, xmlSchemaBinLoadData, ctxt));
+    xmlRegexpSave(regexp, ctxt->buf, xmlSchemaBinSaveData, ctxt);
+    return(regexp);
+}
+
+static xmlSchemaValPtr
+xmlSchemaBinVal(xmlSchemaBinCtxtPtr ctxt, xmlSchemaValPtr val)
+{
+    if (ctxt->load)
+	return(xmlSchemaValLoad(&ctxt->reader));
+    xmlSchemaValSave(val, ctxt->buf);
+    return(val);
+}
+
+static void *
+xmlSchemaBinMalloc(xmlSchemaBinCtxtPtr ctxt, size_t size)
+{
+    void *ret;
+
+    ret = xmlMalloc(size);
+    if (ret == NULL) {
+	xmlSchemaPErrMemory(NULL);
+	ctxt->reader.error = 1;
+	return(NULL);
+    }
+    memset(ret, 0, size);
+    return(ret);
+}
+
+static xmlSchemaTypeLinkPtr
+xmlSchemaBinTypeLinks(xmlSchemaBinCtxtPtr ctxt, xmlSchemaTypeLinkPtr list)
+{
+    xmlSchemaTypeLinkPtr link, last = NULL;
+    int n = 0, i;
+
+    for (link = list; link != NULL; link = link->next)
+	n++;
+    n = xmlSchemaBinCount(ctxt, n);
+    if (! ctxt->load) {
+	for (link = list; link != NULL; link = link->next)
+	    xmlSchemaBinRef(ctxt, link->type);
+	return(list);
+    }
+    for (i = 0; i < n; i++) {
+	link = xmlSchemaBinMalloc(ctxt, sizeof(xmlSchemaTypeLink));
+	if (link == NULL)
+	    break;
+	link->type = xmlSchemaBinRef(ctxt, NULL);
+	if (last == NULL)
+	    list = link;
+	else
+	    last->next = link;
+	last = link;
+    }
+    return(list);
+}
+
+static xmlSchemaFacetLinkPtr
+xmlSchemaBinFacetLinks(xmlSchemaBinCtxtPtr ctxt, xmlSchemaFacetLinkPtr list)
+{
+    xmlSchemaFacetLinkPtr link, last = NULL;
+    int n = 0, i;
+
+    for (link = list; link != NULL; link = link->next)
+	n++;
+    n = xmlSchemaBinCount(ctxt, n);
+    if (! ctxt->load) {
+	for (link = list; link != NULL; link = link->next)
+	    xmlSchemaBinRef(ctxt, link->facet);
+	return(list);
+    }
+    for (i = 0; i < n; i++) {
+	link = xmlSchemaBinMalloc(ctxt, sizeof(xmlSchemaFacetLink));
+	if (link == NULL)
+	    break;
+	link->facet = xmlSchemaBinRef(ctxt, NULL);
+	if (last == NULL)
+	    list = link;
+	else
+	    last->next = link;
+	last = link;
+    }
+    return(list);
+}
+
+static xmlSchemaWildcardNsPtr
+xmlSchemaBinWildcardNs(xmlSchemaBinCtxtPtr ctxt, xmlSchemaWildcardNsPtr list)
+{
+    xmlSchemaWildcardNsPtr ns, last = NULL;
+    int n = 0, i;
+
+    for (ns = list; ns != NULL; ns = ns->next)
+	n++;
+    n = xmlSchemaBinCount(ctxt, n);
+    if (! ctxt->load) {
+	for (ns = list; ns != NULL; ns = ns->next)
+	    xmlSchemaBinStr(ctxt, ns->value);
+	return(list);
+    }
+    for (i = 0; i < n; i++) {
+	ns = xmlSchemaBinMalloc(ctxt, sizeof(xmlSchemaWildcardNs));
+	if (ns == NULL)
+	    break;
+	ns->value = xmlSchemaBinStr(ctxt, NULL);
+	if (last == NULL)
+	    list = ns;
+	else
+	    last->next = ns;
+	last = ns;
+    }
+    return(list);
+}
+
+static xmlSchemaItemListPtr
+xmlSchemaBinItemList(xmlSchemaBinCtxtPtr ctxt, xmlSchemaItemListPtr list)
+{
+    int n, i;
+
+    n = xmlSchemaBinInt(ctxt, (list != NULL) ? list->nbItems : -1);
+    if (! ctxt->load) {
+	for (i = 0; i < n; i++)
+	    xmlSchemaBinRef(ctxt, list->items[i]);
+	return(list);
+    }
+    if ((n < -1) || (n > (ctxt->reader.end - ctxt->reader.cur) / 4)) {
+	ctxt->reader.error = 1;
+	return(NULL);
+    }
+    if (n < 0)
+	return(NULL);
+    list = xmlSchemaItemListCreate();
+    if (list == NULL) {
+	ctxt->reader.error = 1;
+	return(NULL);
+    }
+    for (i = 0; i < n; i++) {
+	if (xmlSchemaItemListAdd(list, xmlSchemaBinRef(ctxt, NULL)) < 0) {
+	    ctxt->reader.error = 1;
+	    break;
+	}
+    }
+    return(list);
+}
+
+static void
+xmlSchemaBinSelectItem(xmlSchemaBinCtxtPtr ctxt, xmlSchemaIDCSelectPtr sel,
+		       int isField)
+{
+    int nbNs = 0, i;
+
+    sel->idc = xmlSchemaBinRef(ctxt, sel->idc);
+    sel->index = xmlSchemaBinInt(ctxt, sel->index);
+    sel->xpath = xmlSchemaBinStr(ctxt, sel->xpath);
+    if (sel->nsArray != NULL) {
+	while (sel->nsArray[2 * nbNs] != NULL)
+	    nbNs++;
+    }
+    nbNs = xmlSchemaBinCount(ctxt, nbNs);
+    if ((ctxt->load) && (nbNs > 0)) {
+	sel->nsArray = xmlSchemaBinMalloc(ctxt,
+	    (2 * nbNs + 1) * sizeof(const xmlChar *));
+	if (sel->nsArray == NULL)
+	    return;
+    }
+    /* Pairs of namespace name and prefix */
+    for (i = 0; i < 2 * nbNs; i++)
+	sel->nsArray[i] = xmlSchemaBinStr(ctxt, sel->nsArray[i]);
+
+    if ((ctxt->load) && (! ctxt->reader.error)) {
+	sel->xpathComp = (void *) xmlPatterncompile(sel->xpath, NULL,
+	    isField ? XML_PATTERN_XSFIELD : XML_PATTERN_XSSEL, sel->nsArray);
+	if (sel->xpathComp == NULL)
+	    ctxt->reader.error = 1;
+    }
+}
+
+static xmlSchemaIDCSelectPtr
+xmlSchemaBinSelect(xmlSchemaBinCtxtPtr ctxt, xmlSchemaIDCSelectPtr list,
+		   int isField)
+{
+    xmlSchemaIDCSelectPtr sel, last = NULL;
+    int n = 0, i;
+
+    for (sel = list; sel != NULL; sel = sel->next)
+	n++;
+    n = xmlSchemaBinCount(ctxt, n);
+    if (! ctxt->load) {
+	for (sel = list; sel != NULL; sel = sel->next)
+	    xmlSchemaBinSelectItem(ctxt, sel, isField);
+	return(list);
+    }
+    for (i = 0; i < n; i++) {
+	sel = xmlSchemaBinMalloc(ctxt, sizeof(xmlSchemaIDCSelect));
+	if (sel == NULL)
+	    break;
+	if (last == NULL)
+	    list = sel;
+	else
+	    last->next = sel;
+	last = sel;
+	xmlSchemaBinSelectItem(ctxt, sel, isField);
+	if (ctxt->reader.error)
+	    break;
+    }
+    return(list);
+}
+
+static size_t
+xmlSchemaBinItemSize(int type)
+{
+    switch (type) {
+	case XML_SCHEMA_TYPE_SIMPLE:
+	case XML_SCHEMA_TYPE_COMPLEX:
+	    return(sizeof(xmlSchemaType));
+	case XML_SCHEMA_TYPE_ELEMENT:
+	    return(sizeof(xmlSchemaElement));
+	case XML_SCHEMA_TYPE_ATTRIBUTE:
+	    return(sizeof(xmlSchemaAttribute));
+	case XML_SCHEMA_TYPE_ATTRIBUTEGROUP:
+	    return(sizeof(xmlSchemaAttributeGroup));
+	case XML_SCHEMA_TYPE_ATTRIBUTE_USE:
+	    return(sizeof(xmlSchemaAttributeUse));
+	case XML_SCHEMA_EXTRA_ATTR_USE_PROHIB:
+	    return(sizeof(xmlSchemaAttributeUseProhib));
+	case XML_SCHEMA_TYPE_ANY:
+	case XML_SCHEMA_TYPE_ANY_ATTRIBUTE:
+	    return(sizeof(xmlSchemaWildcard));
+	case XML_SCHEMA_TYPE_PARTICLE:
+	    return(sizeof(xmlSchemaParticle));
+	case XML_SCHEMA_TYPE_SEQUENCE:
+	case XML_SCHEMA_TYPE_CHOICE:
+	case XML_SCHEMA_TYPE_ALL:
+	    return(sizeof(xmlSchemaModelGroup));
+	case XML_SCHEMA_TYPE_GROUP:
+	    return(sizeof(xmlSchemaModelGroupDef));
+	case XML_SCHEMA_TYPE_IDC_UNIQUE:
+	case XML_SCHEMA_TYPE_IDC_KEY:
+	case XML_SCHEMA_TYPE_IDC_KEYREF:
+	    return(sizeof(xmlSchemaIDC));
+	case XML_SCHEMA_TYPE_NOTATION:
+	    return(sizeof(xmlSchemaNotation));
+	case XML_SCHEMA_EXTRA_QNAMEREF:
+	    return(sizeof(xmlSchemaQNameRef));
+	default:
+	    break;
+    }
+    if (XML_SCHEMA_BIN_IS_FACET(type))
+	return(sizeof(xmlSchemaFacet));
+    return(0);
+}
+
+/*
+ * Reads or writes the fields of a component. Annotations, nodes and
+ * the fields only used while parsing are left out.
+ */
+static void
+xmlSchemaBinComponent(xmlSchemaBinCtxtPtr ctxt, xmlSchemaBasicItemPtr item)
+{
+    switch (item->type) {
+	case XML_SCHEMA_TYPE_SIMPLE:
+	case XML_SCHEMA_TYPE_COMPLEX: {
+	    xmlSchemaTypePtr type = (xmlSchemaTypePtr) item;
+
+	    type->next = xmlSchemaBinRef(ctxt, type->next);
+	    type->name = xmlSchemaBinStr(ctxt, type->name);
+	    type->subtypes = xmlSchemaBinRef(ctxt, type->subtypes);
+	    type->flags = xmlSchemaBinInt(ctxt, type->flags);
+	    type->contentType = xmlSchemaBinInt(ctxt, type->contentType);
+	    type->base = xmlSchemaBinStr(ctxt, type->base);
+	    type->baseNs = xmlSchemaBinStr(ctxt, type->baseNs);
+	    type->baseType = xmlSchemaBinRef(ctxt, type->baseType);
+	    type->facets = xmlSchemaBinRef(ctxt, type->facets);
+	    type->attributeWildcard =
+		xmlSchemaBinRef(ctxt, type->attributeWildcard);
+	    type->builtInType = xmlSchemaBinInt(ctxt, type->builtInType);
+	    type->memberTypes = xmlSchemaBinTypeLinks(ctxt, type->memberTypes);
+	    type->facetSet = xmlSchemaBinFacetLinks(ctxt, type->facetSet);
+	    type->contentTypeDef = xmlSchemaBinRef(ctxt, type->contentTypeDef);
+	    type->contModel = xmlSchemaBinRegexp(ctxt, type->contModel);
+	    type->targetNamespace =
+		xmlSchemaBinStr(ctxt, type->targetNamespace);
+	    type->attrUses = xmlSchemaBinItemList(ctxt, type->attrUses);
+	    /* The model of <all> groups is rebuilt after loading. */
+	    break;
+	}
+	case XML_SCHEMA_TYPE_ELEMENT: {
+	    xmlSchemaElementPtr elem = (xmlSchemaElementPtr) item;
+
+	    elem->name = xmlSchemaBinStr(ctxt, elem->name);
+	    elem->subtypes = xmlSchemaBinRef(ctxt, elem->subtypes);
+	    elem->flags = xmlSchemaBinInt(ctxt, elem->flags);
+	    elem->targetNamespace =
+		xmlSchemaBinStr(ctxt, elem->targetNamespace);
+	    elem->namedType = xmlSchemaBinStr(ctxt, elem->namedType);
+	    elem->namedTypeNs = xmlSchemaBinStr(ctxt, elem->namedTypeNs);
+	    elem->substGroup = xmlSchemaBinStr(ctxt, elem->substGroup);
+	    elem->substGroupNs = xmlSchemaBinStr(ctxt, elem->substGroupNs);
+	    elem->scope = xmlSchemaBinStr(ctxt, elem->scope);
+	    elem->value = xmlSchemaBinStr(ctxt, elem->value);
+	    elem->refDecl = xmlSchemaBinRef(ctxt, elem->refDecl);
+	    elem->contModel = xmlSchemaBinRegexp(ctxt, elem->contModel);
+	    elem->contentType = xmlSchemaBinInt(ctxt, elem->contentType);
+	    elem->defVal = xmlSchemaBinVal(ctxt, elem->defVal);
+	    elem->idcs = xmlSchemaBinRef(ctxt, elem->idcs);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_ATTRIBUTE: {
+	    xmlSchemaAttributePtr attr = (xmlSchemaAttributePtr) item;
+
+	    attr->name = xmlSchemaBinStr(ctxt, attr->name);
+	    attr->typeName = xmlSchemaBinStr(ctxt, attr->typeName);
+	    attr->typeNs = xmlSchemaBinStr(ctxt, attr->typeNs);
+	    attr->defValue = xmlSchemaBinStr(ctxt, attr->defValue);
+	    attr->subtypes = xmlSchemaBinRef(ctxt, attr->subtypes);
+	    attr->targetNamespace =
+		xmlSchemaBinStr(ctxt, attr->targetNamespace);
+	    attr->flags = xmlSchemaBinInt(ctxt, attr->flags);
+	    attr->defVal = xmlSchemaBinVal(ctxt, attr->defVal);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_ATTRIBUTEGROUP: {
+	    xmlSchemaAttributeGroupPtr group =
+		(xmlSchemaAttributeGroupPtr) item;
+
+	    group->name = xmlSchemaBinStr(ctxt, group->name);
+	    group->flags = xmlSchemaBinInt(ctxt, group->flags);
+	    group->attributeWildcard =
+		xmlSchemaBinRef(ctxt, group->attributeWildcard);
+	    group->targetNamespace =
+		xmlSchemaBinStr(ctxt, group->targetNamespace);
+	    group->attrUses = xmlSchemaBinItemList(ctxt, group->attrUses);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_ATTRIBUTE_USE: {
+	    xmlSchemaAttributeUsePtr use = (xmlSchemaAttributeUsePtr) item;
+
+	    use->next = xmlSchemaBinRef(ctxt, use->next);
+	    use->attrDecl = xmlSchemaBinRef(ctxt, use->attrDecl);
+	    use->flags = xmlSchemaBinInt(ctxt, use->flags);
+	    use->occurs = xmlSchemaBinInt(ctxt, use->occurs);
+	    use->defValue = xmlSchemaBinStr(ctxt, use->defValue);
+	    use->defVal = xmlSchemaBinVal(ctxt, use->defVal);
+	    break;
+	}
+	case XML_SCHEMA_EXTRA_ATTR_USE_PROHIB: {
+	    xmlSchemaAttributeUseProhibPtr prohib =
+		(xmlSchemaAttributeUseProhibPtr) item;
+
+	    prohib->name = xmlSchemaBinStr(ctxt, prohib->name);
+	    prohib->targetNamespace =
+		xmlSchemaBinStr(ctxt, prohib->targetNamespace);
+	    prohib->isRef = xmlSchemaBinInt(ctxt, prohib->isRef);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_ANY:
+	case XML_SCHEMA_TYPE_ANY_ATTRIBUTE: {
+	    xmlSchemaWildcardPtr wild = (xmlSchemaWildcardPtr) item;
+
+	    wild->processContents =
+		xmlSchemaBinInt(ctxt, wild->processContents);
+	    wild->any = xmlSchemaBinInt(ctxt, wild->any);
+	    wild->nsSet = xmlSchemaBinWildcardNs(ctxt, wild->nsSet);
+	    wild->negNsSet = xmlSchemaBinWildcardNs(ctxt, wild->negNsSet);
+	    wild->flags = xmlSchemaBinInt(ctxt, wild->flags);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_PARTICLE: {
+	    xmlSchemaParticlePtr particle = (xmlSchemaParticlePtr) item;
+
+	    particle->next = xmlSchemaBinRef(ctxt, particle->next);
+	    particle->children = xmlSchemaBinRef(ctxt, particle->children);
+	    particle->minOccurs = xmlSchemaBinInt(ctxt, particle->minOccurs);
+	    particle->maxOccurs = xmlSchemaBinInt(ctxt, particle->maxOccurs);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_SEQUENCE:
+	case XML_SCHEMA_TYPE_CHOICE:
+	case XML_SCHEMA_TYPE_ALL: {
+	    xmlSchemaModelGroupPtr group = (xmlSchemaModelGroupPtr) item;
+
+	    group->next = xmlSchemaBinRef(ctxt, group->next);
+	    group->children = xmlSchemaBinRef(ctxt, group->children);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_GROUP: {
+	    xmlSchemaModelGroupDefPtr def = (xmlSchemaModelGroupDefPtr) item;
+
+	    def->next = xmlSchemaBinRef(ctxt, def->next);
+	    def->children = xmlSchemaBinRef(ctxt, def->children);
+	    def->name = xmlSchemaBinStr(ctxt, def->name);
+	    def->targetNamespace =
+		xmlSchemaBinStr(ctxt, def->targetNamespace);
+	    def->flags = xmlSchemaBinInt(ctxt, def->flags);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_IDC_UNIQUE:
+	case XML_SCHEMA_TYPE_IDC_KEY:
+	case XML_SCHEMA_TYPE_IDC_KEYREF: {
+	    xmlSchemaIDCPtr idc = (xmlSchemaIDCPtr) item;
+
+	    idc->next = xmlSchemaBinRef(ctxt, idc->next);
+	    idc->name = xmlSchemaBinStr(ctxt, idc->name);
+	    idc->targetNamespace =
+		xmlSchemaBinStr(ctxt, idc->targetNamespace);
+	    idc->selector = xmlSchemaBinSelect(ctxt, idc->selector, 0);
+	    idc->fields = xmlSchemaBinSelect(ctxt, idc->fields, 1);
+	    idc->nbFields = xmlSchemaBinInt(ctxt, idc->nbFields);
+	    idc->ref = xmlSchemaBinRef(ctxt, idc->ref);
+	    break;
+	}
+	case XML_SCHEMA_TYPE_NOTATION: {
+	    xmlSchemaNotationPtr nota = (xmlSchemaNotationPtr) item;
+
+	    nota->name = xmlSchemaBinStr(ctxt, nota->name);
+	    nota->identifier = xmlSchemaBinStr(ctxt, nota->identifier);
+	    nota->targetNamespace =
+		xmlSchemaBinStr(ctxt, nota->targetNamespace);
+	    break;
+	}
+	case XML_SCHEMA_EXTRA_QNAMEREF: {
+	    xmlSchemaQNameRefPtr ref = (xmlSchemaQNameRefPtr) item;
+
+	    ref->item = xmlSchemaBinRef(ctxt, ref->item);
+	    ref->itemType = xmlSchemaBinInt(ctxt, ref->itemType);
+	    ref->name = xmlSchemaBinStr(ctxt, ref->name);
+	    ref->targetNamespace =
+		xmlSchemaBinStr(ctxt, ref->targetNamespace);
+	    break;
+	}
+	default:
+	    if (XML_SCHEMA_BIN_IS_FACET(item->type)) {
+		xmlSchemaFacetPtr facet = (xmlSchemaFacetPtr) item;
+
+		facet->next = xmlSchemaBinRef(ctxt, facet->next);
+		facet->value = xmlSchemaBinStr(ctxt, facet->value);
+		facet->fixed = xmlSchemaBinInt(ctxt, facet->fixed);
+		facet->whitespace = xmlSchemaBinInt(ctxt, facet->whitespace);
+		facet->val = xmlSchemaBinVal(ctxt, facet->val);
+		facet->regexp = xmlSchemaBinRegexp(ctxt, facet->regexp);
+	    } else {
+		/* Not a component of compiled schemas */
+		ctxt->error = 1;
+		ctxt->reader.error = 1;
+	    }
+	    break;
+    }
+}
+
+static void
+xmlSchemaBinSaveEntry(void *payload, void *data, const xmlChar *name)
+{
+    xmlSchemaBinCtxtPtr ctxt = (xmlSchemaBinCtxtPtr) data;
+
+    xmlSchemaBinStr(ctxt, name);
+    xmlSchemaBinRef(ctxt, payload);
+}
+
+static xmlHashTablePtr
+xmlSchemaBinHash(xmlSchemaBinCtxtPtr ctxt, xmlHashTablePtr table)
+{
+    const xmlChar **names;
+    void **items;
+    int n, i;
+
+    n = xmlSchemaBinInt(ctxt, xmlHashSize(table));
+    if (! ctxt->load) {
+	xmlHashScan(table, xmlSchemaBinSaveEntry, ctxt);
+	return(table);
+    }
+    if ((n < -1) || (n > (ctxt->reader.end - ctxt->reader.cur) / 8)) {
+	ctxt->reader.error = 1;
+	return(NULL);
+    }
+    if (n < 0)
+	return(NULL);
+    table = xmlHashCreateDict(n, ctxt->dict);
+    if (table == NULL) {
+	xmlSchemaPErrMemory(NULL);
+	ctxt->reader.error = 1;
+	return(NULL);
+    }
+    xmlHashIndexInterned(table);
+    if (n == 0)
+	return(table);
+
+    /*
+     * Add all entries at once, the table only has to be sized once.
+     */
+    names = xmlMalloc(n * sizeof(names[0]));
+    items = xmlMalloc(n * sizeof(items[0]));
+    if ((names == NULL) || (items == NULL)) {
+	xmlSchemaPErrMemory(NULL);
+	ctxt->reader.error = 1;
+	goto done;
+    }
+    for (i = 0; i < n; i++) {
+	names[i] = xmlSchemaBinStr(ctxt, NULL);
+	items[i] = xmlSchemaBinRef(ctxt, NULL);
+	if ((names[i] == NULL) || (items[i] == NULL)) {
+	    ctxt->reader.error = 1;
+	    goto done;
+	}
+    }
+    if (xmlHashAddEntries(table, n, names, items) != n)
+	ctxt->reader.error = 1;
+
+done:
+    xmlFree(names);
+    xmlFree(items);
+    return(table);
+}
+
+static xmlSchemaPtr
+xmlSchemaBinNewSchema(xmlSchemaBinCtxtPtr ctxt)
+{
+    xmlSchemaPtr ret;
+
+    ret = xmlSchemaBinMalloc(ctxt, sizeof(xmlSchema));
+    if (ret == NULL)
+	return(NULL);
+    ret->dict = ctxt->dict;
+    xmlDictReference(ret->dict);
+    return(ret);
+}
+
+static void
+xmlSchemaBinSchema(xmlSchemaBinCtxtPtr ctxt, xmlSchemaPtr schema)
+{
+    schema->name = xmlSchemaBinStr(ctxt, schema->name);
+    schema->targetNamespace = xmlSchemaBinStr(ctxt, schema->targetNamespace);
+    schema->version = xmlSchemaBinStr(ctxt, schema->version);
+    schema->flags = xmlSchemaBinInt(ctxt, schema->flags);
+    schema->counter = xmlSchemaBinInt(ctxt, schema->counter);
+    schema->typeDecl = xmlSchemaBinHash(ctxt, schema->typeDecl);
+    schema->attrDecl = xmlSchemaBinHash(ctxt, schema->attrDecl);
+    schema->attrgrpDecl = xmlSchemaBinHash(ctxt, schema->attrgrpDecl);
+    schema->elemDecl = xmlSchemaBinHash(ctxt, schema->elemDecl);
+    schema->notaDecl = xmlSchemaBinHash(ctxt, schema->notaDecl);
+    schema->groupDecl = xmlSchemaBinHash(ctxt, schema->groupDecl);
+    schema->idcDef = xmlSchemaBinHash(ctxt, schema->idcDef);
+}
+
+/*
+ * Buckets of the main and the imported schemas. The components
+ * themselves are reached from the schemas, the lists of components of
+ * the buckets aren't saved.
+ */
+static void
+xmlSchemaBinBucket(xmlSchemaBinCtxtPtr ctxt, xmlSchemaImportPtr import)
+{
+    import->type = xmlSchemaBinInt(ctxt, import->type);
+    import->schemaLocation = xmlSchemaBinStr(ctxt, import->schemaLocation);
+    import->origTargetNamespace =
+	xmlSchemaBinStr(ctxt, import->origTargetNamespace);
+    import->targetNamespace = xmlSchemaBinStr(ctxt, import->targetNamespace);
+    import->located = xmlSchemaBinInt(ctxt, import->located);
+    import->parsed = xmlSchemaBinInt(ctxt, import->parsed);
+    import->imported = xmlSchemaBinInt(ctxt, import->imported);
+    if ((import->type == XML_SCHEMA_SCHEMA_IMPORT) &&
+	(xmlSchemaBinInt(ctxt, import->schema != NULL))) {
+	if (ctxt->load) {
+	    import->schema = xmlSchemaBinNewSchema(ctxt);
+	    if (import->schema == NULL)
+		return;
+	}
+	xmlSchemaBinSchema(ctxt, import->schema);
+    }
+}
+
+static void
+xmlSchemaBinSaveBucket(void *payload, void *data, const xmlChar *name)
+{
+    xmlSchemaBinCtxtPtr ctxt = (xmlSchemaBinCtxtPtr) data;
+
+    xmlSchemaBinStr(ctxt, name);
+    xmlSchemaBinBucket(ctxt, (xmlSchemaImportPtr) payload);
+}
+
+static void
+xmlSchemaBinLoadBuckets(xmlSchemaBinCtxtPtr ctxt, xmlSchemaPtr schema)
+{
+    xmlSchemaImportPtr import;
+    const xmlChar *name;
+    int n, i;
+
+    n = xmlSchemaBinCount(ctxt, 0);
+    schema->schemasImports = xmlHashCreateDict(n, ctxt->dict);
+    if (schema->schemasImports == NULL) {
+	xmlSchemaPErrMemory(NULL);
+	ctxt->reader.error = 1;
+	return;
+    }
+    xmlHashIndexInterned(schema->schemasImports);
+    for (i = 0; (i < n) && (! ctxt->reader.error); i++) {
+	name = xmlSchemaBinStr(ctxt, NULL);
+	import = xmlSchemaBinMalloc(ctxt, sizeof(xmlSchemaImport));
+	if (import == NULL)
+	    return;
+	xmlSchemaBinBucket(ctxt, import);
+	if (import->type == XML_SCHEMA_SCHEMA_MAIN) {
+	    if (ctxt->locals == NULL) {
+		/* Only one main bucket */
+		ctxt->reader.error = 1;
+	    } else {
+		import->schema = schema;
+		import->locals = ctxt->locals;
+		ctxt->locals = NULL;
+	    }
+	} else if (import->type != XML_SCHEMA_SCHEMA_IMPORT) {
+	    ctxt->reader.error = 1;
+	}
+	if ((name == NULL) ||
+	    (xmlHashAddEntry(schema->schemasImports, name, import) < 0)) {
+	    if (import->locals != NULL) {
+		ctxt->locals = import->locals;
+		import->locals = NULL;
+	    }
+	    xmlSchemaBucketFree((xmlSchemaBucketPtr) import);
+	    ctxt->reader.error = 1;
+	}
+    }
+}
+
+static int
+xmlSchemaBinAddBuiltin(xmlSchemaBinCtxtPtr ctxt, void *item)
+{
+    if (xmlSchemaItemListAdd(ctxt->builtins, item) < 0)
+	return(-1);
+    if ((! ctxt->load) &&
+	(xmlSchemaBinMapPut(ctxt, item, -ctxt->builtins->nbItems) < 0))
+	return(-1);
+    return(0);
+}
+
+/*
+ * The objects of the built-in types are numbered the same way when
+ * writing and reading.
+ */
+static int
+xmlSchemaBinAddBuiltins(xmlSchemaBinCtxtPtr ctxt)
+{
+    xmlSchemaTypePtr type;
+    xmlSchemaFacetPtr facet;
+    xmlSchemaTreeItemPtr item;
+    int i;
+
+    for (i = 1; i <= XML_SCHEMAS_ANYSIMPLETYPE; i++) {
+	type = xmlSchemaGetBuiltInType((xmlSchemaValType) i);
+	if (type == NULL)
+	    continue;
+	if (xmlSchemaBinAddBuiltin(ctxt, type) < 0)
+	    return(-1);
+	for (facet = type->facets; facet != NULL; facet = facet->next) {
+	    if (xmlSchemaBinAddBuiltin(ctxt, facet) < 0)
+		return(-1);
+	}
+	if ((type->attributeWildcard != NULL) &&
+	    (xmlSchemaBinAddBuiltin(ctxt, type->attributeWildcard) < 0))
+	    return(-1);
+	/* The content model of anyType */
+	item = (xmlSchemaTreeItemPtr) type->subtypes;
+	while ((item != NULL) &&
+	       ((item->type == XML_SCHEMA_TYPE_PARTICLE) ||
+		(item->type == XML_SCHEMA_TYPE_SEQUENCE))) {
+	    if (xmlSchemaBinAddBuiltin(ctxt, item) < 0)
+		return(-1);
+	    item = item->children;
+	}
+	if ((item != NULL) && (item->type == XML_SCHEMA_TYPE_ANY) &&
+	    (xmlSchemaBinAddBuiltin(ctxt, item) < 0))
+	    return(-1);
+    }
+    return(0);
+}
+
+static void
+xmlSchemaBinClear(xmlSchemaBinCtxtPtr ctxt)
+{
+    xmlSchemaItemListFree(ctxt->items);
+    xmlSchemaItemListFree(ctxt->builtins);
+    xmlSchemaItemListFree(ctxt->strings);
+    if (ctxt->locals != NULL) {
+	xmlSchemaComponentListFree(ctxt->locals);
+	xmlSchemaItemListFree(ctxt->locals);
+    }
+    if (ctxt->strIndex != NULL)
+	xmlHashFree(ctxt->strIndex, NULL);
+    if (ctxt->map != NULL)
+	xmlFree(ctxt->map);
+    if (ctxt->strTable != NULL)
+	xmlFree((xmlChar **) ctxt->strTable);
+    if (ctxt->buf != NULL)
+	xmlBufFree(ctxt->buf);
+    if (ctxt->dict != NULL)
+	xmlDictFree(ctxt->dict);
+}
+
+/**
+ * Serialize a compiled schema, including the automata of its content
+ * models and patterns, to a binary form which can be loaded with
+ * #xmlSchemaLoadMemory much faster than parsing the schema documents.
+ *
+ * The format is only readable by the same version of the library.
+ *
+ * @since 2.16.0
+ * @param schema  a compiled schema
+ * @param mem  pointer to the resulting buffer, to be freed with xmlFree
+ * @param size  pointer to the size of the buffer
+ * @returns 0 on success, -1 in case of error.
+ */
+int
+xmlSchemaSaveMemory(xmlSchema *schema, xmlChar **mem, int *size)
+{
+    xmlSchemaBinCtxt ctxt;
+    xmlBufPtr out = NULL;
+    size_t len;
+    int i, ret = -1;
+
+    if (mem != NULL)
+	*mem = NULL;
+    if (size != NULL)
+	*size = 0;
+    if ((schema == NULL) || (mem == NULL) || (size == NULL))
+	return(-1);
+
+    memset(&ctxt, 0, sizeof(ctxt));
+    ctxt.items = xmlSchemaItemListCreate();
+    ctxt.builtins = xmlSchemaItemListCreate();
+    ctxt.strings = xmlSchemaItemListCreate();
+    ctxt.strIndex = xmlHashCreate(0);
+    ctxt.buf = xmlBufCreate(4096);
+    out = xmlBufCreate(4096);
+    if ((ctxt.items == NULL) || (ctxt.builtins == NULL) ||
+	(ctxt.strings == NULL) || (ctxt.strIndex == NULL) ||
+	(ctxt.buf == NULL) || (out == NULL) ||
+	(xmlSchemaBinAddBuiltins(&ctxt) < 0))
+	goto done;
+
+    /*
+    * Write the body first, it collects the strings and components.
+    */
+    xmlSchemaBinSchema(&ctxt, schema);
+    xmlSchemaBinCount(&ctxt, xmlHashSize(schema->schemasImports));
+    xmlHashScan(schema->schemasImports, xmlSchemaBinSaveBucket, &ctxt);
+    for (i = 0; (i < ctxt.items->nbItems) && (! ctxt.error); i++)
+	xmlSchemaBinComponent(&ctxt, ctxt.items->items[i]);
+    if (ctxt.error)
+	goto done;
+
+    xmlBufAdd(out, BAD_CAST XML_SCHEMA_BIN_MAGIC, 4);
+    xmlBinWriteInt(out, XML_SCHEMA_BIN_VERSION);
+    xmlBinWriteInt(out, ctxt.builtins->nbItems);
+    xmlBinWriteInt(out, ctxt.strings->nbItems);
+    for (i = 0; i < ctxt.strings->nbItems; i++)
+	xmlBinWriteString(out, ctxt.strings->items[i]);
+    xmlBinWriteInt(out, ctxt.items->nbItems);
+    for (i = 0; i < ctxt.items->nbItems; i++)
+	xmlBinWriteInt(out,
+	    ((xmlSchemaBasicItemPtr) ctxt.items->items[i])->type);
+    xmlBufAdd(out, xmlBufContent(ctxt.buf), xmlBufUse(ctxt.buf));
+
+    len = xmlBufUse(out);
+    if (len > INT_MAX)
+	goto done;
+    *mem = xmlBufDetach(out);
+    if (*mem == NULL) {
+	xmlSchemaPErrMemory(NULL);
+	goto done;
+    }
+    *size = len;
+    ret = 0;
+
+done:
+    xmlBufFree(out);
+    xmlSchemaBinClear(&ctxt);
+    return(ret);
+}
+
+#ifdef LIBXML_OUTPUT_ENABLED
+/**
+ * Serialize a compiled schema to a file, see #xmlSchemaSaveMemory.
+ *
+ * @since 2.16.0
+ * @param schema  a compiled schema
+ * @param filename  the file name or URI
+ * @returns 0 on success, -1 in case of error.
+ */
+int
+xmlSchemaSave(xmlSchema *schema, const char *filename)
+{
+    xmlOutputBufferPtr out;
+    xmlChar *mem;
+    int size;
+
+    if (filename == NULL)
+	return(-1);
+    if (xmlSchemaSaveMemory(schema, &mem, &size) < 0)
+	return(-1);
+    out = xmlOutputBufferCreateFilename(filename, NULL, 0);
+    if (out == NULL) {
+	xmlFree(mem);
+	return(-1);
+    }
+    xmlOutputBufferWrite(out, size, (const char *) mem);
+    xmlFree(mem);
+    if (xmlOutputBufferClose(out) < 0)
+	return(-1);
+    return(0);
+}
+#endif /* LIBXML_OUTPUT_ENABLED */
+
+/**
+ * Load a compiled schema serialized by #xmlSchemaSaveMemory. The
+ * buffer can be freed or unmapped once the function returns.
  *
- * @param ctxt  a XMl-Schema parser context
- * @param err  the error callback result
- * @param warn  the warning callback result
- * @param ctx  contextual data for the callbacks result
- * @returns -1 in case of failure, 0 otherwise
+ * The input must have been written by the same version of the
+ * library. It's checked for truncation and bad references but not
+ * meant to be untrusted.
+ *
+ * @since 2.16.0
+ * @param mem  the serialized schema
+ * @param size  the size of the buffer
+ * @returns the compiled schema or NULL in case of error.
  */
-int
-xmlSchemaGetParserErrors(xmlSchemaParserCtxt *ctxt,
-			 xmlSchemaValidityErrorFunc * err,
-			 xmlSchemaValidityWarningFunc * warn, void **ctx)
+xmlSchema *
+xmlSchemaLoadMemory(const char *mem, int size)
 {
-	if (ctxt == NULL)
-		return(-1);
-	if (err != NULL)
-		*err = ctxt->error;
-	if (warn != NULL)
-		*warn = ctxt->warning;
-	if (ctx != NULL)
-		*ctx = ctxt->errCtxt;
-	return(0);
+    xmlSchemaBinCtxt ctxt;
+    xmlSchemaPtr schema = NULL;
+    xmlSchemaBasicItemPtr item;
+    size_t itemSize;
+    int i, n, type;
+
+    if ((mem == NULL) || (size < 8) ||
+	(memcmp(mem, XML_SCHEMA_BIN_MAGIC, 4) != 0))
+	return(NULL);
+
+    memset(&ctxt, 0, sizeof(ctxt));
+    ctxt.load = 1;
+    ctxt.reader.cur = (const unsigned char *) mem + 4;
+    ctxt.reader.end = (const unsigned char *) mem + size;
+    if (xmlBinReadInt(&ctxt.reader) != XML_SCHEMA_BIN_VERSION)
+	return(NULL);
+
+    ctxt.items = xmlSchemaItemListCreate();
+    ctxt.builtins = xmlSchemaItemListCreate();
+    ctxt.locals = xmlSchemaItemListCreate();
+    ctxt.dict = xmlDictCreate();
+    if ((ctxt.items == NULL) || (ctxt.builtins == NULL) ||
+	(ctxt.locals == NULL) || (ctxt.dict == NULL) ||
+	(xmlSchemaBinAddBuiltins(&ctxt) < 0) ||
+	(xmlBinReadInt(&ctxt.reader) != ctxt.builtins->nbItems))
+	goto error;
+
+    n = xmlSchemaBinCount(&ctxt, 0);
+    if (n > 0) {
+	ctxt.strTable = xmlMalloc(n * sizeof(const xmlChar *));
+	if (ctxt.strTable == NULL) {
+	    xmlSchemaPErrMemory(NULL);
+	    goto error;
+	}
+    }
+    for (i = 0; i < n; i++) {
+	const xmlChar *str;
+	int len;
+
+	str = xmlBinReadString(&ctxt.reader, &len);
+	if (str == NULL)
+	    goto error;
+	ctxt.strTable[i] = xmlDictLookup(ctxt.dict, str, len);
+	if (ctxt.strTable[i] == NULL) {
+	    xmlSchemaPErrMemory(NULL);
+	    goto error;
+	}
+	ctxt.nbStrTable = i + 1;
+    }
+
+    /*
+    * Allocate all components first, so that references can be
+    * resolved while reading. Facets are owned by the types, the other
+    * components by the main bucket.
+    */
+    n = xmlSchemaBinCount(&ctxt, 0);
+    for (i = 0; (i < n) && (! ctxt.reader.error); i++) {
+	type = xmlBinReadInt(&ctxt.reader);
+	itemSize = xmlSchemaBinItemSize(type);
+	if (itemSize == 0)
+	    goto error;
+	item = xmlSchemaBinMalloc(&ctxt, itemSize);
+	if (item == NULL)
+	    goto error;
+	item->type = type;
+	if (xmlSchemaItemListAdd(ctxt.items, item) < 0) {
+	    xmlFree(item);
+	    goto error;
+	}
+	if ((! XML_SCHEMA_BIN_IS_FACET(type)) &&
+	    (xmlSchemaItemListAdd(ctxt.locals, item) < 0)) {
+	    ctxt.items->nbItems--;
+	    xmlFree(item);
+	    goto error;
+	}
+    }
+
+    schema = xmlSchemaBinNewSchema(&ctxt);
+    if (schema == NULL)
+	goto error;
+    xmlSchemaBinSchema(&ctxt, schema);
+    xmlSchemaBinLoadBuckets(&ctxt, schema);
+    for (i = 0; (i < ctxt.items->nbItems) && (! ctxt.reader.error); i++)
+	xmlSchemaBinComponent(&ctxt, ctxt.items->items[i]);
+    if ((ctxt.reader.error) || (ctxt.locals != NULL) ||
+	(ctxt.reader.cur != ctxt.reader.end))
+	goto error;
+
+    for (i = 0; i < ctxt.items->nbItems; i++) {
+	xmlSchemaTypePtr ctype = ctxt.items->items[i];
+
+	if (ctype->type == XML_SCHEMA_TYPE_COMPLEX) {
+	    if (ctype->contModel != NULL) {
+		xmlSchemaBuildAllModel(ctype, NULL);
+		if (xmlRegexpBuildNameTable(ctype->contModel,
+					    schema->dict) < 0)
+		    xmlSchemaPErrMemory(NULL);
+	    }
+	    xmlSchemaBuildWildcardIndex(ctype->attributeWildcard, NULL);
+	} else if (ctype->type == XML_SCHEMA_TYPE_SIMPLE) {
+	    xmlSchemaBuildEnumIndex(ctype, NULL);
+	}
+    }
+
+    xmlSchemaBinClear(&ctxt);
+    return(schema);
+
+error:
+    /*
+    * The chains of facets of the types might be incomplete, so free
+    * the facets directly.
+    */
+    if (ctxt.items != NULL) {
+	for (i = 0; i < ctxt.items->nbItems; i++) {
+	    item = ctxt.items->items[i];
+	    if ((item->type == XML_SCHEMA_TYPE_SIMPLE) ||
+		(item->type == XML_SCHEMA_TYPE_COMPLEX))
+		((xmlSchemaTypePtr) item)->facets = NULL;
+	}
+	for (i = 0; i < ctxt.items->nbItems; i++) {
+	    item = ctxt.items->items[i];
+	    if (XML_SCHEMA_BIN_IS_FACET(item->type))
+		xmlSchemaFreeFacet((xmlSchemaFacetPtr) item);
+	}
+    }
+    if (schema != NULL)
+	xmlSchemaFree(schema);
+    xmlSchemaBinClear(&ctxt);
+    return(NULL);
 }
 
 /**
- * Register a callback function that will be called to load documents
- * or external entities.
+ * Load a compiled schema from a file written by #xmlSchemaSave.
  *
- * @since 2.14.0
- * @param ctxt  schema parser
- * @param loader  resource loader
- * @param data  user data which will be passed to the loader
+ * @since 2.16.0
+ * @param filename  the file name or URI
+ * @returns the compiled schema or NULL in case of error.
  */
-void
-xmlSchemaSetResourceLoader(xmlSchemaParserCtxt *ctxt,
-                           xmlResourceLoader loader, void *data) {
-    if (ctxt == NULL)
-        return;
-    ctxt->resourceLoader = loader;
-    ctxt->resourceCtxt = data;
+xmlSchema *
+xmlSchemaLoad(const char *filename)
+{
+    xmlParserInputBufferPtr in;
+    xmlSchemaPtr ret = NULL;
+    int res;
+
+    if ((filename == NULL) ||
+	(xmlParserInputBufferCreateUrl(filename, XML_CHAR_ENCODING_NONE, 0,
+				       &in) != XML_ERR_OK))
+	return(NULL);
+    do {
+	res = xmlParserInputBufferGrow(in, 65536);
+    } while (res > 0);
+    if ((res == 0) && (xmlBufUse(in->buffer) <= INT_MAX))
+	ret = xmlSchemaLoadMemory((const char *) xmlBufContent(in->buffer),
+				  xmlBufUse(in->buffer));
+    xmlFreeParserInputBuffer(in);
+    return(ret);
 }
 
 /**
@@ -21292,6 +24405,10 @@ xmlSchemaGetMetaAttrInfo(xmlSchemaValidCtxtPtr vctxt,
     return (NULL);
 }
 
+static void *
+xmlSchemaVGetGlobal(xmlSchemaValidCtxtPtr vctxt, int type,
+                    const xmlChar *name, const xmlChar *nsName);
+
 /**
  * Expands an existing schema by an additional schema using
  * the xsi:schemaLocation or xsi:noNamespaceSchemaLocation attribute
@@ -21485,7 +24602,10 @@ xmlSchemaValidateNotation(xmlSchemaValidCtxtPtr vctxt,
 		xmlFree(localName);
 		return (1);
 	    }
-	    if (xmlSchemaGetNotation(schema, localName, nsName) != NULL) {
+	    if (((vctxt != NULL) ?
+                 xmlSchemaVGetGlobal(vctxt, XML_SCHEMA_TYPE_NOTATION,
+                                     localName, nsName) :
+                 xmlSchemaGetNotation(schema, localName, nsName)) != NULL) {
 		if ((valNeeded) && (val != NULL)) {
 		    (*val) = xmlSchemaNewNOTATIONValue(xmlStrdup(localName),
 						       xmlStrdup(nsName));
@@ -21497,7 +24617,10 @@ xmlSchemaValidateNotation(xmlSchemaValidCtxtPtr vctxt,
 	    xmlFree(prefix);
 	    xmlFree(localName);
 	} else {
-	    if (xmlSchemaGetNotation(schema, value, NULL) != NULL) {
+	    if (((vctxt != NULL) ?
+                 xmlSchemaVGetGlobal(vctxt, XML_SCHEMA_TYPE_NOTATION,
+                                     value, NULL) :
+                 xmlSchemaGetNotation(schema, value, NULL)) != NULL) {
 		if (valNeeded && (val != NULL)) {
 		    (*val) = xmlSchemaNewNOTATIONValue(
 			BAD_CAST xmlStrdup(value), NULL);
@@ -21607,6 +24730,169 @@ xmlSchemaAugmentImportedIDC(void *payload, void *data,
     }
 }
 
+static void
+xmlSchemaLazyAddBucket(void *payload, void *data,
+                       const xmlChar *name ATTRIBUTE_UNUSED)
+{
+    xmlSchemaItemListAdd((xmlSchemaItemListPtr) data, payload);
+}
+
+/**
+ * Load the pending import of a namespace used by an instance.
+ * Must be called with the lock of the lazy imports held.
+ *
+ * @param vctxt  the schema validation context
+ * @param nsName  the namespace
+ * @returns 1 if new schemas were added, 0 otherwise and -1 in case
+ * of an internal error.
+ */
+static int
+xmlSchemaLazyImportLoad(xmlSchemaValidCtxtPtr vctxt, const xmlChar *nsName)
+{
+    xmlSchemaPtr schema = vctxt->schema;
+    xmlSchemaLazyImportsPtr lazy = schema->lazyImports;
+    xmlSchemaParserCtxtPtr pctxt;
+    xmlSchemaConstructionCtxtPtr con;
+    xmlSchemaBucketPtr bucket;
+    int i, nbBuckets, ret;
+
+    if (xmlSchemaLazyImportMark(lazy, nsName) == 0)
+        return(0);
+
+    if ((lazy->loaded == NULL) &&
+        ((lazy->loaded = xmlSchemaItemListCreate()) == NULL)) {
+        xmlSchemaVErrMemory(vctxt);
+        return(-1);
+    }
+    pctxt = xmlSchemaNewParserCtxtUseDict("*", schema->dict);
+    if (pctxt == NULL) {
+        xmlSchemaVErrMemory(vctxt);
+        return(-1);
+    }
+    xmlSchemaSetParserErrors(pctxt, vctxt->error, vctxt->warning,
+        vctxt->errCtxt);
+    xmlSchemaSetParserStructuredErrors(pctxt, vctxt->serror,
+        vctxt->errCtxt);
+    pctxt->resourceLoader = lazy->resourceLoader;
+    pctxt->resourceCtxt = lazy->resourceCtxt;
+    pctxt->lazyImports = 1;
+    pctxt->schema = schema;
+
+    /*
+    * Rebuild the list of buckets so that schema documents
+    * which were already loaded are found.
+    */
+    con = xmlSchemaConstructionCtxtCreate(schema->dict);
+    if (con == NULL) {
+        xmlSchemaFreeParserCtxt(pctxt);
+        return(-1);
+    }
+    pctxt->constructor = con;
+    pctxt->ownsConstructor = 1;
+    con->mainSchema = schema;
+    con->mainBucket = xmlHashLookup(schema->schemasImports,
+        (schema->targetNamespace != NULL) ?
+            schema->targetNamespace : XML_SCHEMAS_NO_NAMESPACE);
+    xmlHashScan(schema->schemasImports, xmlSchemaLazyAddBucket, con->buckets);
+    if (schema->includes != NULL) {
+        xmlSchemaItemListPtr list = (xmlSchemaItemListPtr) schema->includes;
+
+        for (i = 0; i < list->nbItems; i++)
+            xmlSchemaItemListAdd(con->buckets, list->items[i]);
+    }
+    nbBuckets = con->buckets->nbItems;
+
+    ret = xmlSchemaLazyImportLoadRequested(pctxt, schema);
+    if ((ret == 0) && (pctxt->nberrors == 0) &&
+        (con->buckets->nbItems > nbBuckets)) {
+        xmlSchemaFixupComponents(pctxt, con->buckets->items[nbBuckets]);
+        ret = pctxt->err;
+    }
+    if ((ret != 0) && (vctxt->err == 0))
+        vctxt->err = ret;
+    vctxt->nberrors += pctxt->nberrors;
+
+    for (i = nbBuckets; i < con->buckets->nbItems; i++) {
+        bucket = con->buckets->items[i];
+        if ((WXS_IS_BUCKET_IMPMAIN(bucket->type)) &&
+            (xmlSchemaItemListAdd(lazy->loaded, bucket) < 0))
+            ret = -1;
+    }
+    i = con->buckets->nbItems - nbBuckets;
+    xmlSchemaFreeParserCtxt(pctxt);
+
+    if (ret < 0)
+        return(-1);
+    return(i > 0);
+}
+
+/**
+ * Augment the IDC definitions of imports loaded since the last
+ * call. Must be called with the lock of the lazy imports held.
+ *
+ * @param vctxt  the schema validation context
+ */
+static void
+xmlSchemaLazyAugmentIDC(xmlSchemaValidCtxtPtr vctxt)
+{
+    xmlSchemaLazyImportsPtr lazy = vctxt->schema->lazyImports;
+
+    if (lazy->loaded == NULL)
+        return;
+    while (vctxt->lazyAugmented < lazy->loaded->nbItems) {
+        xmlSchemaAugmentImportedIDC(
+            lazy->loaded->items[vctxt->lazyAugmented++], vctxt, NULL);
+    }
+}
+
+static void *
+xmlSchemaGetGlobal(xmlSchemaPtr schema, int type,
+                   const xmlChar *name, const xmlChar *nsName)
+{
+    switch (type) {
+        case XML_SCHEMA_TYPE_ELEMENT:
+            return(xmlSchemaGetElem(schema, name, nsName));
+        case XML_SCHEMA_TYPE_ATTRIBUTE:
+            return(xmlSchemaGetAttributeDecl(schema, name, nsName));
+        case XML_SCHEMA_TYPE_NOTATION:
+            return(xmlSchemaGetNotation(schema, name, nsName));
+        default:
+            return(xmlSchemaGetType(schema, name, nsName));
+    }
+}
+
+/**
+ * Look up a global component during validation. With lazy imports,
+ * the import of the namespace is loaded if it is still pending.
+ *
+ * @param vctxt  the schema validation context
+ * @param type  XML_SCHEMA_TYPE_ELEMENT, XML_SCHEMA_TYPE_ATTRIBUTE,
+ * XML_SCHEMA_TYPE_NOTATION or XML_SCHEMA_TYPE_BASIC for types
+ * @param name  the local name
+ * @param nsName  the namespace name
+ * @returns the component or NULL if not found.
+ */
+static void *
+xmlSchemaVGetGlobal(xmlSchemaValidCtxtPtr vctxt, int type,
+                    const xmlChar *name, const xmlChar *nsName)
+{
+    xmlSchemaPtr schema = vctxt->schema;
+    xmlSchemaLazyImportsPtr lazy = schema->lazyImports;
+    void *ret;
+
+    if (lazy == NULL)
+        return(xmlSchemaGetGlobal(schema, type, name, nsName));
+
+    xmlMutexLock(&lazy->lock);
+    ret = xmlSchemaGetGlobal(schema, type, name, nsName);
+    if ((ret == NULL) && (xmlSchemaLazyImportLoad(vctxt, nsName) > 0))
+        ret = xmlSchemaGetGlobal(schema, type, name, nsName);
+    xmlSchemaLazyAugmentIDC(vctxt);
+    xmlMutexUnlock(&lazy->lock);
+
+    return(ret);
+}
+
 /**
  * Creates a new IDC binding.
  *
@@ -21808,6 +25094,17 @@ xmlSchemaIDCFreeKey(xmlSchemaPSVIIDCKeyPtr key)
     xmlFree(key);
 }
 
+static void
+xmlFreeIDCHashEntry (void *payload, const xmlChar *name ATTRIBUTE_UNUSED)
+{
+    xmlIDCHashEntryPtr e = payload, n;
+    while (e) {
+	n = e->next;
+	xmlFree(e);
+	e = n;
+    }
+}
+
 /**
  * Frees an IDC binding. Note that the node table-items
  * are not freed.
@@ -21819,6 +25116,10 @@ xmlSchemaIDCFreeBinding(xmlSchemaPSVIIDCBindingPtr bind)
 	xmlFree(bind->nodeTable);
     if (bind->dupls != NULL)
 	xmlSchemaItemListFree(bind->dupls);
+    if (bind->nodeHash != NULL)
+	xmlHashFree(bind->nodeHash, xmlFreeIDCHashEntry);
+    if (bind->duplHash != NULL)
+	xmlHashFree(bind->duplHash, xmlFreeIDCHashEntry);
     xmlFree(bind);
 }
 
@@ -21839,17 +25140,6 @@ xmlSchemaIDCFreeIDCTable(xmlSchemaPSVIIDCBindingPtr bind)
     }
 }
 
-static void
-xmlFreeIDCHashEntry (void *payload, const xmlChar *name ATTRIBUTE_UNUSED)
-{
-    xmlIDCHashEntryPtr e = payload, n;
-    while (e) {
-	n = e->next;
-	xmlFree(e);
-	e = n;
-    }
-}
-
 /**
  * Frees a list of IDC matchers.
  *
@@ -22177,16 +25467,265 @@ xmlSchemaFormatIDCKeySequence(xmlSchemaValidCtxtPtr vctxt,
 			      xmlSchemaPSVIIDCKeyPtr *seq,
 			      int count)
 {
-    return xmlSchemaFormatIDCKeySequence_1(vctxt, buf, seq, count, 0);
+    return xmlSchemaFormatIDCKeySequence_1(vctxt, buf, seq, count, 0);
+}
+
+static const xmlChar *
+xmlSchemaHashKeySequence(xmlSchemaValidCtxtPtr vctxt,
+			 xmlChar **buf,
+			 xmlSchemaPSVIIDCKeyPtr *seq,
+			 int count)
+{
+    return xmlSchemaFormatIDCKeySequence_1(vctxt, buf, seq, count, 1);
+}
+
+/*
+ * IDC target lists, node tables and lists of duplicates are indexed
+ * by hash tables which map the hash string of a key-sequence to a
+ * chain of positions in the list. The indices of bindings are
+ * created on demand by xmlSchemaIDCIndexBinding and only maintained
+ * once they exist.
+ */
+
+/**
+ * Adds a position to an IDC index.
+ *
+ * @param vctxt  the WXS validation context
+ * @param table  the index
+ * @param value  the hash string of the key-sequence
+ * @param index  the position of the key-sequence
+ * @returns 0 on success and -1 on internal errors.
+ */
+static int
+xmlSchemaIDCHashAdd(xmlSchemaValidCtxtPtr vctxt, xmlHashTablePtr table,
+                    const xmlChar *value, int index)
+{
+    xmlIDCHashEntryPtr r, e;
+
+    e = xmlMalloc(sizeof *e);
+    if (e == NULL) {
+        xmlSchemaVErrMemory(vctxt);
+        return(-1);
+    }
+    e->index = index;
+    r = xmlHashLookup(table, value);
+    if (r) {
+        e->next = r->next;
+        r->next = e;
+    } else {
+        e->next = NULL;
+        if (xmlHashAddEntry(table, value, e) < 0) {
+            xmlSchemaVErrMemory(vctxt);
+            xmlFree(e);
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+/**
+ * Looks up a key-sequence in an IDC index.
+ *
+ * @param table  the index (optional)
+ * @param value  the hash string of the key-sequence
+ * @param items  the indexed IDC node-table items
+ * @param keys  the key-sequence
+ * @param nbFields  the number of keys
+ * @returns the position of an item with an equal key-sequence, -1 if
+ *         none was found and -2 on internal errors.
+ */
+static int
+xmlSchemaIDCHashFind(xmlHashTablePtr table, const xmlChar *value,
+                     xmlSchemaPSVIIDCNodePtr *items,
+                     xmlSchemaPSVIIDCKeyPtr *keys, int nbFields)
+{
+    xmlIDCHashEntryPtr e;
+    xmlSchemaPSVIIDCKeyPtr *ikeys;
+    int k, res;
+
+    if (table == NULL)
+        return(-1);
+    for (e = xmlHashLookup(table, value); e != NULL; e = e->next) {
+        ikeys = items[e->index]->keys;
+        res = 1;
+        for (k = 0; k < nbFields; k++) {
+            res = xmlSchemaAreValuesEqual(keys[k]->val, ikeys[k]->val);
+            if (res == -1)
+                return(-2);
+            if (res == 0)
+                break;
+        }
+        if (res == 1)
+            return(e->index);
+    }
+    return(-1);
+}
+
+/**
+ * Creates the missing indices of an IDC binding.
+ *
+ * @param vctxt  the WXS validation context
+ * @param bind  the IDC binding
+ * @returns 0 on success and -1 on internal errors.
+ */
+static int
+xmlSchemaIDCIndexBinding(xmlSchemaValidCtxtPtr vctxt,
+                         xmlSchemaPSVIIDCBindingPtr bind)
+{
+    int nbFields = bind->definition->nbFields;
+    xmlChar *value = NULL;
+    int i, res;
+
+    if (bind->nodeHash == NULL) {
+        bind->nodeHash = xmlHashCreate(bind->nbNodes);
+        if (bind->nodeHash == NULL) {
+            xmlSchemaVErrMemory(vctxt);
+            return(-1);
+        }
+        for (i = 0; i < bind->nbNodes; i++) {
+            xmlSchemaHashKeySequence(vctxt, &value,
+                                     bind->nodeTable[i]->keys, nbFields);
+            if (value == NULL) {
+                xmlSchemaVErrMemory(vctxt);
+                return(-1);
+            }
+            res = xmlSchemaIDCHashAdd(vctxt, bind->nodeHash, value, i);
+            FREE_AND_NULL(value);
+            if (res < 0)
+                return(-1);
+        }
+    }
+    if ((bind->duplHash == NULL) && (! WXS_ILIST_IS_EMPTY(bind->dupls))) {
+        bind->duplHash = xmlHashCreate(bind->dupls->nbItems);
+        if (bind->duplHash == NULL) {
+            xmlSchemaVErrMemory(vctxt);
+            return(-1);
+        }
+        for (i = 0; i < bind->dupls->nbItems; i++) {
+            xmlSchemaHashKeySequence(vctxt, &value,
+                ((xmlSchemaPSVIIDCNodePtr) bind->dupls->items[i])->keys,
+                nbFields);
+            if (value == NULL) {
+                xmlSchemaVErrMemory(vctxt);
+                return(-1);
+            }
+            res = xmlSchemaIDCHashAdd(vctxt, bind->duplHash, value, i);
+            FREE_AND_NULL(value);
+            if (res < 0)
+                return(-1);
+        }
+    }
+    return(0);
+}
+
+/**
+ * Appends an item to the node table of an IDC binding.
+ *
+ * @param vctxt  the WXS validation context
+ * @param bind  the IDC binding
+ * @param item  the node-table item
+ * @param value  the hash string of the item's key-sequence
+ * @returns 0 on success and -1 on internal errors.
+ */
+static int
+xmlSchemaIDCBindingAppend(xmlSchemaValidCtxtPtr vctxt,
+                          xmlSchemaPSVIIDCBindingPtr bind,
+                          xmlSchemaPSVIIDCNodePtr item,
+                          const xmlChar *value)
+{
+    if (xmlSchemaIDCAppendNodeTableItem(bind, item) == -1)
+        return(-1);
+    if ((bind->nodeHash != NULL) &&
+        (xmlSchemaIDCHashAdd(vctxt, bind->nodeHash, value,
+                             bind->nbNodes - 1) < 0))
+        return(-1);
+    return(0);
 }
 
-static const xmlChar *
-xmlSchemaHashKeySequence(xmlSchemaValidCtxtPtr vctxt,
-			 xmlChar **buf,
-			 xmlSchemaPSVIIDCKeyPtr *seq,
-			 int count)
+/**
+ * Moves an item from the node table of an IDC binding to the list
+ * of duplicates. The last item of the node table takes its place.
+ *
+ * @param vctxt  the WXS validation context
+ * @param bind  the IDC binding
+ * @param index  the position of the item in the node table
+ * @param value  the hash string of the item's key-sequence
+ * @returns 0 on success and -1 on internal errors.
+ */
+static int
+xmlSchemaIDCBindingMoveToDupls(xmlSchemaValidCtxtPtr vctxt,
+                               xmlSchemaPSVIIDCBindingPtr bind,
+                               int index, const xmlChar *value)
 {
-    return xmlSchemaFormatIDCKeySequence_1(vctxt, buf, seq, count, 1);
+    xmlSchemaPSVIIDCNodePtr item = bind->nodeTable[index];
+    int last = bind->nbNodes - 1;
+
+    if (bind->dupls == NULL) {
+        bind->dupls = xmlSchemaItemListCreate();
+        if (bind->dupls == NULL)
+            return(-1);
+    }
+    if (xmlSchemaItemListAdd(bind->dupls, item) == -1)
+        return(-1);
+    if ((bind->duplHash != NULL) &&
+        (xmlSchemaIDCHashAdd(vctxt, bind->duplHash, value,
+                             bind->dupls->nbItems - 1) < 0))
+        return(-1);
+
+    if (bind->nodeHash != NULL) {
+        xmlIDCHashEntryPtr r, e, prev = NULL;
+        xmlChar *lastValue = NULL;
+
+        /*
+        * Unlink the entry of the item.
+        */
+        r = xmlHashLookup(bind->nodeHash, value);
+        for (e = r; (e != NULL) && (e->index != index); e = e->next)
+            prev = e;
+        if (e == NULL) {
+            VERROR_INT("xmlSchemaIDCBindingMoveToDupls",
+                "missing index entry");
+            return(-1);
+        }
+        if (prev != NULL) {
+            prev->next = e->next;
+            xmlFree(e);
+        } else if (e->next != NULL) {
+            e = r->next;
+            r->index = e->index;
+            r->next = e->next;
+            xmlFree(e);
+        } else {
+            xmlHashRemoveEntry(bind->nodeHash, value, xmlFreeIDCHashEntry);
+        }
+
+        /*
+        * Update the entry of the last item.
+        */
+        if (index != last) {
+            xmlSchemaHashKeySequence(vctxt, &lastValue,
+                                     bind->nodeTable[last]->keys,
+                                     bind->definition->nbFields);
+            if (lastValue == NULL) {
+                xmlSchemaVErrMemory(vctxt);
+                return(-1);
+            }
+            e = xmlHashLookup(bind->nodeHash, lastValue);
+            FREE_AND_NULL(lastValue);
+            while ((e != NULL) && (e->index != last))
+                e = e->next;
+            if (e == NULL) {
+                VERROR_INT("xmlSchemaIDCBindingMoveToDupls",
+                    "missing index entry");
+                return(-1);
+            }
+            e->index = index;
+        }
+    }
+
+    bind->nodeTable[index] = bind->nodeTable[last];
+    bind->nbNodes--;
+    return(0);
 }
 
 /**
@@ -22429,8 +25968,19 @@ create_key:
 		    * Consume the compiled value.
 		    */
 		    key->type = simpleType;
-		    key->val = vctxt->inode->val;
-		    vctxt->inode->val = NULL;
+		    if (vctxt->keepValues) {
+			key->val = xmlSchemaCopyValue(vctxt->inode->val);
+			if (key->val == NULL) {
+			    xmlSchemaVErrMemory(vctxt);
+			    xmlFree(key);
+			    xmlFree(keySeq);
+			    matcher->keySeqs[pos] = NULL;
+			    return(-1);
+			}
+		    } else {
+			key->val = vctxt->inode->val;
+			vctxt->inode->val = NULL;
+		    }
 		    /*
 		    * Store the key in a global list.
 		    */
@@ -22449,7 +25999,7 @@ create_key:
 	    xmlSchemaIDCMatcherPtr matcher;
 	    xmlSchemaIDCPtr idc;
 	    xmlSchemaItemListPtr targets;
-	    int pos, i, j, nbKeys;
+	    int pos, i, nbKeys;
 	    /*
 	    * Here we have the following scenario:
 	    * An IDC 'selector' state object resolved to a target node,
@@ -22521,48 +26071,16 @@ create_key:
 
 	    if ((idc->type != XML_SCHEMA_TYPE_IDC_KEYREF) &&
 		(targets->nbItems != 0)) {
-		xmlSchemaPSVIIDCKeyPtr ckey, bkey, *bkeySeq;
-		xmlIDCHashEntryPtr e;
-
-		res = 0;
-
-		if (!matcher->htab)
-		    e = NULL;
-		else {
-		    xmlChar *value = NULL;
-		    xmlSchemaHashKeySequence(vctxt, &value, *keySeq, nbKeys);
-		    e = xmlHashLookup(matcher->htab, value);
-		    FREE_AND_NULL(value);
-		}
+		xmlChar *value = NULL;
 
-		/*
-		* Compare the key-sequences, key by key.
-		*/
-		for (;e; e = e->next) {
-		    bkeySeq =
-			((xmlSchemaPSVIIDCNodePtr) targets->items[e->index])->keys;
-		    for (j = 0; j < nbKeys; j++) {
-			ckey = (*keySeq)[j];
-			bkey = bkeySeq[j];
-			res = xmlSchemaAreValuesEqual(ckey->val, bkey->val);
-			if (res == -1) {
-			    return (-1);
-			} else if (res == 0) {
-			    /*
-			    * One of the keys differs, so the key-sequence
-			    * won't be equal; get out.
-			    */
-			    break;
-			}
-		    }
-		    if (res == 1) {
-			/*
-			* Duplicate key-sequence found.
-			*/
-			break;
-		    }
-		}
-		if (e) {
+		xmlSchemaHashKeySequence(vctxt, &value, *keySeq, nbKeys);
+		res = xmlSchemaIDCHashFind(matcher->htab, value,
+		    (xmlSchemaPSVIIDCNodePtr *) targets->items,
+		    *keySeq, nbKeys);
+		FREE_AND_NULL(value);
+		if (res == -2)
+		    return (-1);
+		if (res >= 0) {
 		    xmlChar *str = NULL, *strB = NULL;
 		    /*
 		    * TODO: Try to report the key-sequence.
@@ -22641,29 +26159,20 @@ create_key:
 	    }
 	    if (idc->type != XML_SCHEMA_TYPE_IDC_KEYREF) {
 		xmlChar *value = NULL;
-		xmlIDCHashEntryPtr r, e;
-		if (!matcher->htab)
-		  matcher->htab = xmlHashCreate(4);
-		xmlSchemaHashKeySequence(vctxt, &value, ntItem->keys, nbKeys);
-		e = xmlMalloc(sizeof *e);
-                if (e == NULL) {
-                    xmlSchemaVErrMemory(vctxt);
-                    goto mem_error;
-                }
-		e->index = targets->nbItems - 1;
-		r = xmlHashLookup(matcher->htab, value);
-		if (r) {
-		    e->next = r->next;
-		    r->next = e;
-		} else {
-		    e->next = NULL;
-		    if (xmlHashAddEntry(matcher->htab, value, e) < 0) {
-                        xmlSchemaVErrMemory(vctxt);
-                        xmlFree(e);
-                    }
+
+		if (!matcher->htab) {
+		    matcher->htab = xmlHashCreate(4);
+		    if (matcher->htab == NULL) {
+			xmlSchemaVErrMemory(vctxt);
+			return (-1);
+		    }
 		}
-mem_error:
+		xmlSchemaHashKeySequence(vctxt, &value, ntItem->keys, nbKeys);
+		res = xmlSchemaIDCHashAdd(vctxt, matcher->htab, value,
+		    targets->nbItems - 1);
 		FREE_AND_NULL(value);
+		if (res < 0)
+		    return (-1);
 	    }
 
 	    goto selector_leave;
@@ -22842,9 +26351,10 @@ xmlSchemaIDCFillNodeTables(xmlSchemaValidCtxtPtr vctxt,
 			   xmlSchemaNodeInfoPtr ielem)
 {
     xmlSchemaPSVIIDCBindingPtr bind;
-    int res, i, j, k, nbTargets, nbFields, nbDupls, nbNodeTable;
-    xmlSchemaPSVIIDCKeyPtr *keys, *ntkeys;
-    xmlSchemaPSVIIDCNodePtr *targets, *dupls;
+    int res, i, nbTargets, nbFields, nbDupls, nbNodeTable;
+    xmlSchemaPSVIIDCKeyPtr *keys;
+    xmlSchemaPSVIIDCNodePtr *targets;
+    xmlChar *value = NULL;
 
     xmlSchemaIDCMatcherPtr matcher = ielem->idcMatchers;
     /* vctxt->createIDCNodeTables */
@@ -22876,13 +26386,10 @@ xmlSchemaIDCFillNodeTables(xmlSchemaValidCtxtPtr vctxt,
 	if (bind == NULL)
 	   goto internal_error;
 
-	if (! WXS_ILIST_IS_EMPTY(bind->dupls)) {
-	    dupls = (xmlSchemaPSVIIDCNodePtr *) bind->dupls->items;
+	if (! WXS_ILIST_IS_EMPTY(bind->dupls))
 	    nbDupls = bind->dupls->nbItems;
-	} else {
-	    dupls = NULL;
+	else
 	    nbDupls = 0;
-	}
 	if (bind->nodeTable != NULL) {
 	    nbNodeTable = bind->nbNodes;
 	} else {
@@ -22903,10 +26410,13 @@ xmlSchemaIDCFillNodeTables(xmlSchemaValidCtxtPtr vctxt,
 	    matcher->targets->items = NULL;
 	    matcher->targets->sizeItems = 0;
 	    matcher->targets->nbItems = 0;
-	    if (matcher->htab) {
-		xmlHashFree(matcher->htab, xmlFreeIDCHashEntry);
-		matcher->htab = NULL;
-	    }
+	    /*
+	    * The index of the targets becomes the index of the node-table.
+	    */
+	    if (bind->nodeHash != NULL)
+		xmlHashFree(bind->nodeHash, xmlFreeIDCHashEntry);
+	    bind->nodeHash = matcher->htab;
+	    matcher->htab = NULL;
 	} else {
 	    /*
 	    * Compare the key-sequences and add to the IDC node-table.
@@ -22914,120 +26424,62 @@ xmlSchemaIDCFillNodeTables(xmlSchemaValidCtxtPtr vctxt,
 	    nbTargets = matcher->targets->nbItems;
 	    targets = (xmlSchemaPSVIIDCNodePtr *) matcher->targets->items;
 	    nbFields = matcher->aidc->def->nbFields;
-	    i = 0;
-	    do {
+	    if (xmlSchemaIDCIndexBinding(vctxt, bind) < 0)
+		goto internal_error;
+	    for (i = 0; i < nbTargets; i++) {
 		keys = targets[i]->keys;
-		if (nbDupls) {
-		    /*
-		    * Search in already found duplicates first.
-		    */
-		    j = 0;
-		    do {
-			if (nbFields == 1) {
-			    res = xmlSchemaAreValuesEqual(keys[0]->val,
-				dupls[j]->keys[0]->val);
-			    if (res == -1)
-				goto internal_error;
-			    if (res == 1) {
-				/*
-				* Equal key-sequence.
-				*/
-				goto next_target;
-			    }
-			} else {
-			    res = 0;
-			    ntkeys = dupls[j]->keys;
-			    for (k = 0; k < nbFields; k++) {
-				res = xmlSchemaAreValuesEqual(keys[k]->val,
-				    ntkeys[k]->val);
-				if (res == -1)
-				    goto internal_error;
-				if (res == 0) {
-				    /*
-				    * One of the keys differs.
-				    */
-				    break;
-				}
-			    }
-			    if (res == 1) {
-				/*
-				* Equal key-sequence found.
-				*/
-				goto next_target;
-			    }
-			}
-			j++;
-		    } while (j < nbDupls);
+		xmlSchemaHashKeySequence(vctxt, &value, keys, nbFields);
+		if (value == NULL) {
+		    xmlSchemaVErrMemory(vctxt);
+		    goto internal_error;
 		}
-		if (bind->nbNodes) {
-		    j = 0;
-		    do {
-			if (nbFields == 1) {
-			    res = xmlSchemaAreValuesEqual(keys[0]->val,
-				bind->nodeTable[j]->keys[0]->val);
-			    if (res == -1)
-				goto internal_error;
-			    if (res == 0) {
-				/*
-				* The key-sequence differs.
-				*/
-				goto next_node_table_entry;
-			    }
-			} else {
-			    res = 0;
-			    ntkeys = bind->nodeTable[j]->keys;
-			    for (k = 0; k < nbFields; k++) {
-				res = xmlSchemaAreValuesEqual(keys[k]->val,
-				    ntkeys[k]->val);
-				if (res == -1)
-				    goto internal_error;
-				if (res == 0) {
-				    /*
-				    * One of the keys differs.
-				    */
-				    goto next_node_table_entry;
-				}
-			    }
-			}
-			/*
-			* Add the duplicate to the list of duplicates.
-			*/
-			if (bind->dupls == NULL) {
-			    bind->dupls = xmlSchemaItemListCreate();
-			    if (bind->dupls == NULL)
-				goto internal_error;
-			}
-			if (xmlSchemaItemListAdd(bind->dupls, bind->nodeTable[j]) == -1)
-			    goto internal_error;
-                        dupls = (xmlSchemaPSVIIDCNodePtr *) bind->dupls->items;
+		/*
+		* Search in already found duplicates first.
+		*/
+		if (bind->duplHash != NULL) {
+		    res = xmlSchemaIDCHashFind(bind->duplHash, value,
+			(xmlSchemaPSVIIDCNodePtr *) bind->dupls->items,
+			keys, nbFields);
+		    if (res == -2)
+			goto internal_error;
+		    if (res >= 0) {
 			/*
-			* Remove the duplicate entry from the IDC node-table.
+			* Equal key-sequence.
 			*/
-			bind->nodeTable[j] = bind->nodeTable[bind->nbNodes -1];
-			bind->nbNodes--;
-
-			goto next_target;
-
-next_node_table_entry:
-			j++;
-		    } while (j < bind->nbNodes);
+			FREE_AND_NULL(value);
+			continue;
+		    }
 		}
-		/*
-		* If everything is fine, then add the IDC target-node to
-		* the IDC node-table.
-		*/
-		if (xmlSchemaIDCAppendNodeTableItem(bind, targets[i]) == -1)
+		res = xmlSchemaIDCHashFind(bind->nodeHash, value,
+		    bind->nodeTable, keys, nbFields);
+		if (res == -2)
 		    goto internal_error;
-
-next_target:
-		i++;
-	    } while (i < nbTargets);
+		if (res >= 0) {
+		    /*
+		    * Move the duplicate from the IDC node-table to the
+		    * list of duplicates.
+		    */
+		    if (xmlSchemaIDCBindingMoveToDupls(vctxt, bind, res,
+			    value) < 0)
+			goto internal_error;
+		} else {
+		    /*
+		    * If everything is fine, then add the IDC target-node to
+		    * the IDC node-table.
+		    */
+		    if (xmlSchemaIDCBindingAppend(vctxt, bind, targets[i],
+			    value) < 0)
+			goto internal_error;
+		}
+		FREE_AND_NULL(value);
+	    }
 	}
 	matcher = matcher->next;
     }
     return(0);
 
 internal_error:
+    FREE_AND_NULL(value);
     return(-1);
 }
 
@@ -23045,9 +26497,10 @@ xmlSchemaBubbleIDCNodeTables(xmlSchemaValidCtxtPtr vctxt)
 {
     xmlSchemaPSVIIDCBindingPtr bind; /* IDC bindings of the current node. */
     xmlSchemaPSVIIDCBindingPtr *parTable, parBind = NULL; /* parent IDC bindings. */
-    xmlSchemaPSVIIDCNodePtr node, parNode = NULL, *dupls, *parNodes; /* node-table entries. */
+    xmlSchemaPSVIIDCNodePtr node; /* node-table entries. */
     xmlSchemaIDCAugPtr aidc;
-    int i, j, k, ret = 0, nbFields, oldNum, oldDupls;
+    xmlChar *value = NULL;
+    int i, j, nbFields;
 
     bind = vctxt->inode->idcTable;
     if (bind == NULL) {
@@ -23094,164 +26547,65 @@ xmlSchemaBubbleIDCNodeTables(xmlSchemaValidCtxtPtr vctxt)
 	}
 
 	if (parBind != NULL) {
+	    nbFields = bind->definition->nbFields;
+	    if (xmlSchemaIDCIndexBinding(vctxt, parBind) < 0)
+		goto internal_error;
+
 	    /*
 	    * Compare every node-table entry of the child node,
 	    * i.e. the key-sequence within, ...
 	    */
-	    oldNum = parBind->nbNodes; /* Skip newly added items. */
-
-	    if (! WXS_ILIST_IS_EMPTY(parBind->dupls)) {
-		oldDupls = parBind->dupls->nbItems;
-		dupls = (xmlSchemaPSVIIDCNodePtr *) parBind->dupls->items;
-	    } else {
-		dupls = NULL;
-		oldDupls = 0;
-	    }
-
-	    parNodes = parBind->nodeTable;
-	    nbFields = bind->definition->nbFields;
-
 	    for (i = 0; i < bind->nbNodes; i++) {
 		node = bind->nodeTable[i];
 		if (node == NULL)
 		    continue;
+		xmlSchemaHashKeySequence(vctxt, &value, node->keys, nbFields);
+		if (value == NULL) {
+		    xmlSchemaVErrMemory(vctxt);
+		    goto internal_error;
+		}
 		/*
 		* ...with every key-sequence of the parent node, already
 		* evaluated to be a duplicate key-sequence.
 		*/
-		if (oldDupls) {
-		    j = 0;
-		    while (j < oldDupls) {
-			if (nbFields == 1) {
-			    ret = xmlSchemaAreValuesEqual(
-				node->keys[0]->val,
-				dupls[j]->keys[0]->val);
-			    if (ret == -1)
-				goto internal_error;
-			    if (ret == 0) {
-				j++;
-				continue;
-			    }
-			} else {
-			    parNode = dupls[j];
-			    for (k = 0; k < nbFields; k++) {
-				ret = xmlSchemaAreValuesEqual(
-				    node->keys[k]->val,
-				    parNode->keys[k]->val);
-				if (ret == -1)
-				    goto internal_error;
-				if (ret == 0)
-				    break;
-			    }
-			}
-			if (ret == 1)
-			    /* Duplicate found. */
-			    break;
-			j++;
-		    }
-		    if (j != oldDupls) {
+		if (parBind->duplHash != NULL) {
+		    j = xmlSchemaIDCHashFind(parBind->duplHash, value,
+			(xmlSchemaPSVIIDCNodePtr *) parBind->dupls->items,
+			node->keys, nbFields);
+		    if (j == -2)
+			goto internal_error;
+		    if (j >= 0) {
 			/* Duplicate found. Skip this entry. */
+			FREE_AND_NULL(value);
 			continue;
 		    }
 		}
 		/*
 		* ... and with every key-sequence of the parent node.
 		*/
-		if (oldNum) {
-		    j = 0;
-		    while (j < oldNum) {
-			parNode = parNodes[j];
-			if (nbFields == 1) {
-			    ret = xmlSchemaAreValuesEqual(
-				node->keys[0]->val,
-				parNode->keys[0]->val);
-			    if (ret == -1)
-				goto internal_error;
-			    if (ret == 0) {
-				j++;
-				continue;
-			    }
-			} else {
-			    for (k = 0; k < nbFields; k++) {
-				ret = xmlSchemaAreValuesEqual(
-				    node->keys[k]->val,
-				    parNode->keys[k]->val);
-				if (ret == -1)
-				    goto internal_error;
-				if (ret == 0)
-				    break;
-			    }
-			}
-			if (ret == 1)
-			    /* Duplicate found. */
-			    break;
-			j++;
-		    }
-		    if (j != oldNum) {
-			/*
-			* Handle duplicates. Move the duplicate in
-			* the parent's node-table to the list of
-			* duplicates.
-			*/
-			oldNum--;
-			parBind->nbNodes--;
-			/*
-			* Move last old item to pos of duplicate.
-			*/
-			parNodes[j] = parNodes[oldNum];
-
-			if (parBind->nbNodes != oldNum) {
-			    /*
-			    * If new items exist, move last new item to
-			    * last of old items.
-			    */
-			    parNodes[oldNum] =
-				parNodes[parBind->nbNodes];
-			}
-			if (parBind->dupls == NULL) {
-			    parBind->dupls = xmlSchemaItemListCreate();
-			    if (parBind->dupls == NULL)
-				goto internal_error;
-			}
-			xmlSchemaItemListAdd(parBind->dupls, parNode);
-		        dupls = (xmlSchemaPSVIIDCNodePtr *)
-                            parBind->dupls->items;
-		    } else {
-			/*
-			* Add the node-table entry (node and key-sequence) of
-			* the child node to the node table of the parent node.
-			*/
-                        if (parBind->nbNodes >= parBind->sizeNodes) {
-                            xmlSchemaPSVIIDCNodePtr *tmp;
-                            int newSize;
-
-                            newSize = xmlGrowCapacity(parBind->sizeNodes,
-                                                      sizeof(tmp[0]),
-                                                      10, XML_MAX_ITEMS);
-                            if (newSize < 0) {
-                                xmlSchemaVErrMemory(vctxt);
-                                goto internal_error;
-                            }
-                            tmp = xmlRealloc(parBind->nodeTable,
-                                             newSize * sizeof(tmp[0]));
-                            if (tmp == NULL) {
-                                xmlSchemaVErrMemory(vctxt);
-                                goto internal_error;
-                            }
-
-                            parBind->nodeTable = tmp;
-                            parBind->sizeNodes = newSize;
-			}
-			parNodes = parBind->nodeTable;
-			/*
-			* Append the new node-table entry to the 'new node-table
-			* entries' section.
-			*/
-			parNodes[parBind->nbNodes++] = node;
-		    }
-
+		j = xmlSchemaIDCHashFind(parBind->nodeHash, value,
+		    parBind->nodeTable, node->keys, nbFields);
+		if (j == -2)
+		    goto internal_error;
+		if (j >= 0) {
+		    /*
+		    * Handle duplicates. Move the duplicate in
+		    * the parent's node-table to the list of
+		    * duplicates.
+		    */
+		    if (xmlSchemaIDCBindingMoveToDupls(vctxt, parBind, j,
+			    value) < 0)
+			goto internal_error;
+		} else {
+		    /*
+		    * Add the node-table entry (node and key-sequence) of
+		    * the child node to the node table of the parent node.
+		    */
+		    if (xmlSchemaIDCBindingAppend(vctxt, parBind, node,
+			    value) < 0)
+			goto internal_error;
 		}
-
+		FREE_AND_NULL(value);
 	    }
 	} else {
 	    /*
@@ -23283,6 +26637,8 @@ xmlSchemaBubbleIDCNodeTables(xmlSchemaValidCtxtPtr vctxt)
 		    bind->sizeNodes = 0;
 		    parBind->nbNodes = bind->nbNodes;
 		    bind->nbNodes = 0;
+		    parBind->nodeHash = bind->nodeHash;
+		    bind->nodeHash = NULL;
 		} else {
 		    /*
 		    * Copy the entries.
@@ -23309,6 +26665,8 @@ xmlSchemaBubbleIDCNodeTables(xmlSchemaValidCtxtPtr vctxt)
 		    xmlSchemaItemListFree(parBind->dupls);
 		parBind->dupls = bind->dupls;
 		bind->dupls = NULL;
+		parBind->duplHash = bind->duplHash;
+		bind->duplHash = NULL;
 	    }
             if (parTable != NULL) {
                 if (*parTable == NULL)
@@ -23326,6 +26684,7 @@ next_binding:
     return (0);
 
 internal_error:
+    FREE_AND_NULL(value);
     return(-1);
 }
 
@@ -23349,10 +26708,8 @@ xmlSchemaCheckCVCIDCKeyRef(xmlSchemaValidCtxtPtr vctxt)
 	    matcher->targets &&
 	    matcher->targets->nbItems)
 	{
-	    int i, j, k, res, nbFields, hasDupls;
-	    xmlSchemaPSVIIDCKeyPtr *refKeys, *keys;
+	    int i, res, nbFields;
 	    xmlSchemaPSVIIDCNodePtr refNode = NULL;
-	    xmlHashTablePtr table = NULL;
 
 	    nbFields = matcher->aidc->def->nbFields;
 
@@ -23366,103 +26723,50 @@ xmlSchemaCheckCVCIDCKeyRef(xmlSchemaValidCtxtPtr vctxt)
 		    break;
 		bind = bind->next;
 	    }
-	    hasDupls = (bind && bind->dupls && bind->dupls->nbItems) ? 1 : 0;
+	    if ((bind != NULL) && (xmlSchemaIDCIndexBinding(vctxt, bind) < 0))
+		return (-1);
 	    /*
 	    * Search for a matching key-sequences.
 	    */
-	    if (bind) {
-		table = xmlHashCreate(bind->nbNodes * 2);
-		for (j = 0; j < bind->nbNodes; j++) {
-		    xmlChar *value;
-		    xmlIDCHashEntryPtr r, e;
-		    keys = bind->nodeTable[j]->keys;
-		    xmlSchemaHashKeySequence(vctxt, &value, keys, nbFields);
-		    e = xmlMalloc(sizeof *e);
-                    if (e == NULL) {
-                        xmlSchemaVErrMemory(vctxt);
-                        goto mem_error;
-                    }
-		    e->index = j;
-		    r = xmlHashLookup(table, value);
-		    if (r) {
-			e->next = r->next;
-			r->next = e;
-		    } else {
-			e->next = NULL;
-                        if (xmlHashAddEntry(table, value, e) < 0) {
-                            xmlSchemaVErrMemory(vctxt);
-                            xmlFree(e);
-                        }
-		    }
-mem_error:
-		    FREE_AND_NULL(value);
-		}
-	    }
 	    for (i = 0; i < matcher->targets->nbItems; i++) {
 		res = 0;
 		refNode = matcher->targets->items[i];
 		if (bind != NULL) {
-		    xmlChar *value;
-		    xmlIDCHashEntryPtr e;
-		    refKeys = refNode->keys;
-		    xmlSchemaHashKeySequence(vctxt, &value, refKeys, nbFields);
-		    e = xmlHashLookup(table, value);
-		    FREE_AND_NULL(value);
-		    res = 0;
-		    for (;e; e = e->next) {
-			keys = bind->nodeTable[e->index]->keys;
-			for (k = 0; k < nbFields; k++) {
-			    res = xmlSchemaAreValuesEqual(keys[k]->val,
-							  refKeys[k]->val);
-			    if (res == 0)
-			        break;
-			    else if (res == -1) {
-				return (-1);
-			    }
-			}
-			if (res == 1) {
-			    /*
-			     * Match found.
-			     */
-			    break;
-			}
-		    }
-		    if ((res == 0) && hasDupls) {
+		    xmlChar *value = NULL;
+
+		    xmlSchemaHashKeySequence(vctxt, &value, refNode->keys,
+			nbFields);
+		    res = xmlSchemaIDCHashFind(bind->nodeHash, value,
+			bind->nodeTable, refNode->keys, nbFields);
+		    if ((res == -1) && (bind->duplHash != NULL)) {
 			/*
 			* Search in duplicates
 			*/
-			for (j = 0; j < bind->dupls->nbItems; j++) {
-			    keys = ((xmlSchemaPSVIIDCNodePtr)
-				bind->dupls->items[j])->keys;
-			    for (k = 0; k < nbFields; k++) {
-				res = xmlSchemaAreValuesEqual(keys[k]->val,
-				    refKeys[k]->val);
-				if (res == 0)
-				    break;
-				else if (res == -1) {
-				    return (-1);
-				}
-			    }
-			    if (res == 1) {
-				/*
-				* Match in duplicates found.
-				*/
-				xmlChar *str = NULL, *strB = NULL;
-				xmlSchemaKeyrefErr(vctxt,
-				    XML_SCHEMAV_CVC_IDC, refNode,
-				    (xmlSchemaTypePtr) matcher->aidc->def,
-				    "More than one match found for "
-				    "key-sequence %s of keyref '%s'",
-				    xmlSchemaFormatIDCKeySequence(vctxt, &str,
-					refNode->keys, nbFields),
-				    xmlSchemaGetComponentQName(&strB,
-					matcher->aidc->def));
-				FREE_AND_NULL(str);
-				FREE_AND_NULL(strB);
-				break;
-			    }
+			res = xmlSchemaIDCHashFind(bind->duplHash, value,
+			    (xmlSchemaPSVIIDCNodePtr *) bind->dupls->items,
+			    refNode->keys, nbFields);
+			if (res >= 0) {
+			    /*
+			    * Match in duplicates found.
+			    */
+			    xmlChar *str = NULL, *strB = NULL;
+			    xmlSchemaKeyrefErr(vctxt,
+				XML_SCHEMAV_CVC_IDC, refNode,
+				(xmlSchemaTypePtr) matcher->aidc->def,
+				"More than one match found for "
+				"key-sequence %s of keyref '%s'",
+				xmlSchemaFormatIDCKeySequence(vctxt, &str,
+				    refNode->keys, nbFields),
+				xmlSchemaGetComponentQName(&strB,
+				    matcher->aidc->def));
+			    FREE_AND_NULL(str);
+			    FREE_AND_NULL(strB);
 			}
 		    }
+		    FREE_AND_NULL(value);
+		    if (res == -2)
+			return (-1);
+		    res = (res >= 0);
 		}
 
 		if (res == 0) {
@@ -23478,9 +26782,6 @@ mem_error:
 		    FREE_AND_NULL(strB);
 		}
 	    }
-	    if (table) {
-		xmlHashFree(table, xmlFreeIDCHashEntry);
-	    }
 	}
 	matcher = matcher->next;
     }
@@ -23632,11 +26933,7 @@ xmlSchemaClearElemInfo(xmlSchemaValidCtxtPtr vctxt,
 	ielem->value = NULL;
     }
     if (ielem->val != NULL) {
-	/*
-	* PSVI TODO: Be careful not to free it when the value is
-	* exposed via PSVI.
-	*/
-	xmlSchemaFreeValue(ielem->val);
+	xmlSchemaKeepValue(vctxt, ielem->node, ielem->val);
 	ielem->val = NULL;
     }
     if (ielem->idcMatchers != NULL) {
@@ -23658,9 +26955,13 @@ xmlSchemaClearElemInfo(xmlSchemaValidCtxtPtr vctxt,
 	ielem->idcTable = NULL;
     }
     if (ielem->regexCtxt != NULL) {
-	xmlRegFreeExecCtxt(ielem->regexCtxt);
+	xmlRegExecPoolPut(vctxt->execPool, ielem->regexCtxt);
 	ielem->regexCtxt = NULL;
     }
+    if (ielem->allExec != NULL) {
+	xmlFree(ielem->allExec);
+	ielem->allExec = NULL;
+    }
     if (ielem->nsBindings != NULL) {
 	xmlFree((xmlChar **)ielem->nsBindings);
 	ielem->nsBindings = NULL;
@@ -23669,6 +26970,61 @@ xmlSchemaClearElemInfo(xmlSchemaValidCtxtPtr vctxt,
     }
 }
 
+/**
+ * @param type  the simple type definition
+ * @returns the facet links of a type which are checked one by one
+ *         during validation. Indexed enumerations are skipped.
+ */
+static xmlSchemaFacetLinkPtr
+xmlSchemaGetValidFacetSet(xmlSchemaTypePtr type)
+{
+    if (type->enumIndex != NULL)
+	return (((xmlSchemaEnumIndexPtr) type->enumIndex)->links);
+    return (type->facetSet);
+}
+
+/**
+ * Checks a value against the enumeration facets of a simple type
+ * with an index.
+ *
+ * @param type  the simple type definition
+ * @param val  the precomputed value
+ * @returns 1 if the value matches an enumeration, 0 if not and -1 on
+ *         internal errors.
+ */
+static int
+xmlSchemaCheckEnumIndex(xmlSchemaTypePtr type, xmlSchemaValPtr val)
+{
+    xmlSchemaEnumIndexPtr index = (xmlSchemaEnumIndexPtr) type->enumIndex;
+    xmlSchemaEnumEntryPtr entry;
+    xmlSchemaFacetPtr facet;
+    xmlChar *value = NULL;
+    int ret;
+
+    if (xmlSchemaGetCanonValueHash(val, &value) == 0) {
+	entry = xmlHashLookup(index->table, value);
+	xmlFree(value);
+	for (; entry != NULL; entry = entry->next) {
+	    ret = xmlSchemaAreValuesEqual(entry->facet->val, val);
+	    if (ret != 0)
+		return (ret);
+	}
+	if (index->exact)
+	    return (0);
+    } else if (value != NULL) {
+	xmlFree(value);
+    }
+
+    for (facet = type->facets; facet != NULL; facet = facet->next) {
+	if (facet->type != XML_SCHEMA_FACET_ENUMERATION)
+	    continue;
+	ret = xmlSchemaAreValuesEqual(facet->val, val);
+	if (ret != 0)
+	    return (ret);
+    }
+    return (0);
+}
+
 /**
  * Creates/reuses and initializes the element info item for
  * the current tree depth.
@@ -23799,7 +27155,7 @@ xmlSchemaValidateFacets(xmlSchemaAbstractCtxtPtr actxt,
 	valType = xmlSchemaGetValType(val);
 
     ret = 0;
-    for (facetLink = type->facetSet; facetLink != NULL;
+    for (facetLink = xmlSchemaGetValidFacetSet(type); facetLink != NULL;
 	facetLink = facetLink->next) {
 	/*
 	* Skip the pattern "whiteSpace": it is used to
@@ -23844,7 +27200,7 @@ WXS_IS_LIST:
     * "length", "minLength" and "maxLength" of list types.
     */
     ret = 0;
-    for (facetLink = type->facetSet; facetLink != NULL;
+    for (facetLink = xmlSchemaGetValidFacetSet(type); facetLink != NULL;
 	facetLink = facetLink->next) {
 
 	switch (facetLink->facet->type) {
@@ -23885,18 +27241,29 @@ pattern_and_enum:
     ret = 0;
     tmpType = type;
     do {
-        for (facet = tmpType->facets; facet != NULL; facet = facet->next) {
-            if (facet->type != XML_SCHEMA_FACET_ENUMERATION)
-                continue;
+        if ((tmpType->enumIndex != NULL) && (val != NULL)) {
             found = 1;
-            ret = xmlSchemaAreValuesEqual(facet->val, val);
-            if (ret == 1)
-                break;
-            else if (ret < 0) {
+            ret = xmlSchemaCheckEnumIndex(tmpType, val);
+            if (ret < 0) {
                 AERROR_INT("xmlSchemaValidateFacets",
                     "validating against an enumeration facet");
                 return (-1);
             }
+        } else {
+            for (facet = tmpType->facets; facet != NULL;
+                 facet = facet->next) {
+                if (facet->type != XML_SCHEMA_FACET_ENUMERATION)
+                    continue;
+                found = 1;
+                ret = xmlSchemaAreValuesEqual(facet->val, val);
+                if (ret == 1)
+                    break;
+                else if (ret < 0) {
+                    AERROR_INT("xmlSchemaValidateFacets",
+                        "validating against an enumeration facet");
+                    return (-1);
+                }
+            }
         }
         if (ret != 0)
             break;
@@ -23930,8 +27297,8 @@ pattern_and_enum:
     facet = NULL;
     do {
         found = 0;
-        for (facetLink = tmpType->facetSet; facetLink != NULL;
-            facetLink = facetLink->next) {
+        for (facetLink = xmlSchemaGetValidFacetSet(tmpType);
+            facetLink != NULL; facetLink = facetLink->next) {
             if (facetLink->facet->type != XML_SCHEMA_FACET_PATTERN)
                 continue;
             found = 1;
@@ -24055,14 +27422,14 @@ xmlSchemaValidateQName(xmlSchemaValidCtxtPtr vctxt,
 * cvc-simple-type
 */
 static int
-xmlSchemaVCheckCVCSimpleType(xmlSchemaAbstractCtxtPtr actxt,
-			     xmlNodePtr node,
-			     xmlSchemaTypePtr type,
-			     const xmlChar *value,
-			     xmlSchemaValPtr *retVal,
-			     int fireErrors,
-			     int normalize,
-			     int isNormalized)
+xmlSchemaVCheckCVCSimpleTypeInternal(xmlSchemaAbstractCtxtPtr actxt,
+				     xmlNodePtr node,
+				     xmlSchemaTypePtr type,
+				     const xmlChar *value,
+				     xmlSchemaValPtr *retVal,
+				     int fireErrors,
+				     int normalize,
+				     int isNormalized)
 {
     int ret = 0, valNeeded = (retVal) ? 1 : 0;
     xmlSchemaValPtr val = NULL;
@@ -24150,7 +27517,18 @@ xmlSchemaVCheckCVCSimpleType(xmlSchemaAbstractCtxtPtr actxt,
 		    ret = xmlSchemaValidateQName((xmlSchemaValidCtxtPtr) actxt,
 			value, &val, valNeeded);
 		    break;
-		default:
+		default: {
+                    xmlMutex *idLock = NULL;
+
+                    /*
+                    * IDs are registered in the document, which is
+                    * shared by the contexts of a parallel run.
+                    */
+                    if ((node != NULL) &&
+                        (biType->builtInType == XML_SCHEMAS_ID))
+                        idLock = ((xmlSchemaValidCtxtPtr) actxt)->parIdLock;
+                    if (idLock != NULL)
+                        xmlMutexLock(idLock);
 		    /* ws = xmlSchemaGetWhiteSpaceFacetValue(type); */
 		    if (valNeeded)
 			ret = xmlSchemaValPredefTypeNodeNoNorm(biType,
@@ -24158,7 +27536,10 @@ xmlSchemaVCheckCVCSimpleType(xmlSchemaAbstractCtxtPtr actxt,
 		    else
 			ret = xmlSchemaValPredefTypeNodeNoNorm(biType,
 			    value, NULL, node);
+                    if (idLock != NULL)
+                        xmlMutexUnlock(idLock);
 		    break;
+                }
 	    }
 	} else if (actxt->type == XML_SCHEMA_CTXT_PARSER) {
 	    switch (biType->builtInType) {
@@ -24395,6 +27776,52 @@ internal_error:
     return (-1);
 }
 
+static int
+xmlSchemaVCheckCVCSimpleType(xmlSchemaAbstractCtxtPtr actxt,
+			     xmlNodePtr node,
+			     xmlSchemaTypePtr type,
+			     const xmlChar *value,
+			     xmlSchemaValPtr *retVal,
+			     int fireErrors,
+			     int normalize,
+			     int isNormalized)
+{
+    xmlSchemaValidCtxtPtr vctxt;
+    xmlSchemaValidProfilePtr prof = NULL;
+    xmlSchemaTypeProfile *entry;
+    clock_t start;
+    double time;
+    int ret;
+
+    if ((actxt != NULL) && (actxt->type == XML_SCHEMA_CTXT_VALIDATOR))
+        prof = ((xmlSchemaValidCtxtPtr) actxt)->profile;
+    /*
+    * Only the outermost check of list items or union members is
+    * profiled.
+    */
+    if ((prof == NULL) || (prof->simpleDepth > 0))
+        return(xmlSchemaVCheckCVCSimpleTypeInternal(actxt, node, type,
+            value, retVal, fireErrors, normalize, isNormalized));
+
+    vctxt = (xmlSchemaValidCtxtPtr) actxt;
+    prof->simpleDepth += 1;
+    start = clock();
+    ret = xmlSchemaVCheckCVCSimpleTypeInternal(actxt, node, type,
+        value, retVal, fireErrors, normalize, isNormalized);
+    time = (double) (clock() - start) / CLOCKS_PER_SEC;
+    prof->simpleDepth -= 1;
+
+    prof->counts[XML_SCHEMA_PROF_SIMPLE] += 1;
+    prof->times[XML_SCHEMA_PROF_SIMPLE] += time;
+    entry = xmlSchemaProfileGetType(vctxt, type);
+    if (entry != NULL) {
+        entry->checks += 1;
+        entry->time += time;
+    }
+
+    return(ret);
+}
+
 static int
 xmlSchemaVExpandQName(xmlSchemaValidCtxtPtr vctxt,
 			   const xmlChar *value,
@@ -24499,7 +27926,8 @@ xmlSchemaProcessXSIType(xmlSchemaValidCtxtPtr vctxt,
 	* (cvc-elt) (3.3.4) : (4.2)
 	* (cvc-assess-elt) (1.2.1.2.3)
 	*/
-	*localType = xmlSchemaGetType(vctxt->schema, local, nsName);
+	*localType = xmlSchemaVGetGlobal(vctxt, XML_SCHEMA_TYPE_BASIC,
+	    local, nsName);
 	if (*localType == NULL) {
 	    xmlChar *str = NULL;
 
@@ -24764,7 +28192,7 @@ xmlSchemaClearAttrInfos(xmlSchemaValidCtxtPtr vctxt)
 		xmlFree((xmlChar *) attr->value);
 	}
 	if (attr->val != NULL) {
-	    xmlSchemaFreeValue(attr->val);
+	    xmlSchemaKeepValue(vctxt, attr->node, attr->val);
 	    attr->val = NULL;
 	}
 	memset(attr, 0, sizeof(xmlSchemaAttrInfo));
@@ -24793,6 +28221,7 @@ xmlSchemaVAttributesComplex(xmlSchemaValidCtxtPtr vctxt)
     int i, j, found, nbAttrs, nbUses;
     int xpathRes = 0, res, wildIDs = 0, fixed;
     xmlNodePtr defAttrOwnerElem = NULL;
+    clock_t start;
 
     /*
     * SPEC (cvc-attribute)
@@ -24918,6 +28347,9 @@ xmlSchemaVAttributesComplex(xmlSchemaValidCtxtPtr vctxt)
     * Validate against the wildcard.
     */
     if (type->attributeWildcard != NULL) {
+	unsigned long nbWild = 0;
+
+	start = xmlSchemaProfileStart(vctxt);
 	/*
 	* SPEC (cvc-complex-type)
 	* (3.2.1) "There must be an {attribute wildcard}."
@@ -24930,6 +28362,7 @@ xmlSchemaVAttributesComplex(xmlSchemaValidCtxtPtr vctxt)
 	    */
 	    if (iattr->state != XML_SCHEMAS_ATTR_UNKNOWN)
 		continue;
+	    nbWild++;
 	    /*
 	    * SPEC (cvc-complex-type)
 	    * (3.2.2) "The attribute information item must be `valid` with
@@ -24966,7 +28399,8 @@ xmlSchemaVAttributesComplex(xmlSchemaValidCtxtPtr vctxt)
 		/*
 		* Find an attribute declaration.
 		*/
-		iattr->decl = xmlSchemaGetAttributeDecl(vctxt->schema,
+		iattr->decl = xmlSchemaVGetGlobal(vctxt,
+		    XML_SCHEMA_TYPE_ATTRIBUTE,
 		    iattr->localName, iattr->nsName);
 		if (iattr->decl != NULL) {
 		    iattr->state = XML_SCHEMAS_ATTR_ASSESSED;
@@ -25028,6 +28462,7 @@ xmlSchemaVAttributesComplex(xmlSchemaValidCtxtPtr vctxt)
 		}
 	    }
 	}
+	xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_WILDCARD, start, nbWild);
     }
 
     if (vctxt->nbAttrInfos == 0)
@@ -25071,8 +28506,10 @@ xmlSchemaVAttributesComplex(xmlSchemaValidCtxtPtr vctxt)
 	    /*
 	    * Evaluate IDCs.
 	    */
+	    start = xmlSchemaProfileStart(vctxt);
 	    xpathRes = xmlSchemaXPathEvaluate(vctxt,
 		XML_ATTRIBUTE_NODE);
+	    xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_IDC, start, 1);
 	    if (xpathRes == -1) {
 		VERROR_INT("xmlSchemaVAttributesComplex",
 		    "calling xmlSchemaXPathEvaluate()");
@@ -25214,7 +28651,10 @@ xmlSchemaVAttributesComplex(xmlSchemaValidCtxtPtr vctxt)
 	* VAL TODO: Do we already have the
 	* "normalized attribute value" here?
 	*/
-	if (xpathRes || fixed) {
+	if (vctxt->profile != NULL)
+	    xmlSchemaProfileNode(vctxt, iattr->typeDef, 1);
+	if (xpathRes || fixed ||
+	    ((vctxt->keepValues) && (iattr->node != NULL))) {
 	    iattr->flags |= XML_SCHEMA_NODE_INFO_VALUE_NEEDED;
 	    /*
 	    * Request a computed value.
@@ -25304,12 +28744,14 @@ eval_idcs:
 	* Evaluate IDCs.
 	*/
 	if (xpathRes) {
+	    start = xmlSchemaProfileStart(vctxt);
 	    if (xmlSchemaXPathProcessHistory(vctxt,
 		vctxt->depth +1) == -1) {
 		VERROR_INT("xmlSchemaVAttributesComplex",
 		    "calling xmlSchemaXPathEvaluate()");
 		goto internal_error;
 	    }
+	    xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_IDC, start, 0);
 	} else if (vctxt->xpathStates != NULL)
 	    xmlSchemaXPathPop(vctxt);
     }
@@ -25409,7 +28851,7 @@ xmlSchemaValidateElemWildcard(xmlSchemaValidCtxtPtr vctxt,
     {
 	xmlSchemaElementPtr decl = NULL;
 
-	decl = xmlSchemaGetElem(vctxt->schema,
+	decl = xmlSchemaVGetGlobal(vctxt, XML_SCHEMA_TYPE_ELEMENT,
 	    vctxt->inode->localName, vctxt->inode->nsName);
 	if (decl != NULL) {
 	    vctxt->inode->decl = decl;
@@ -25535,7 +28977,113 @@ xmlSchemaVContentModelCallback(xmlRegExecCtxtPtr exec ATTRIBUTE_UNUSED,
 {
     xmlSchemaElementPtr item = (xmlSchemaElementPtr) transdata;
     xmlSchemaNodeInfoPtr inode = (xmlSchemaNodeInfoPtr) inputdata;
-    inode->decl = item;
+    /* Replayed <all> children have no node info. */
+    if (inode != NULL)
+        inode->decl = item;
+}
+
+/**
+ * Matches the current element against the <all> model group of its
+ * parent.
+ *
+ * @param vctxt  the schema validation context
+ * @param pielem  the parent element info
+ * @param model  the <all> model of the parent's type
+ * @returns 0 if the element was accepted, 1 if it has to be checked
+ * against the automaton and -1 on internal errors.
+ */
+static int
+xmlSchemaAllPush(xmlSchemaValidCtxtPtr vctxt,
+		 xmlSchemaNodeInfoPtr pielem,
+		 xmlSchemaAllModelPtr model)
+{
+    xmlSchemaAllExecPtr exec = pielem->allExec;
+    xmlSchemaAllParticlePtr item;
+    int i;
+
+    item = (xmlSchemaAllParticlePtr) xmlHashLookup2(model->index,
+	vctxt->inode->localName, vctxt->inode->nsName);
+    if (item == NULL)
+	return (1);
+    i = item - model->particles;
+
+    if (exec == NULL) {
+	size_t size = sizeof(xmlSchemaAllExec) +
+		      model->nbParticles * sizeof(int) +
+		      (model->nbParticles + 7) / 8;
+
+	exec = (xmlSchemaAllExecPtr) xmlMalloc(size);
+	if (exec == NULL) {
+	    xmlSchemaVErrMemory(vctxt);
+	    return (-1);
+	}
+	memset(exec, 0, size);
+	exec->order = (int *) (exec + 1);
+	exec->seen = (unsigned char *) (exec->order + model->nbParticles);
+	pielem->allExec = exec;
+    }
+
+    if (exec->seen[i >> 3] & (1 << (i & 7)))
+	return (1);
+    exec->seen[i >> 3] |= 1 << (i & 7);
+    exec->order[exec->nbSeen++] = i;
+    if (item->required)
+	exec->nbRequiredSeen++;
+    vctxt->inode->decl = item->decl;
+    return (0);
+}
+
+/**
+ * @param model  an <all> model
+ * @param exec  the state of its validation, may be NULL
+ * @returns 1 if the children matched so far satisfy the model, 0
+ * otherwise.
+ */
+static int
+xmlSchemaAllIsComplete(xmlSchemaAllModelPtr model,
+		       xmlSchemaAllExecPtr exec)
+{
+    if ((exec == NULL) || (exec->nbSeen == 0))
+	return ((model->optional) || (model->nbRequired == 0));
+    return (exec->nbRequiredSeen == model->nbRequired);
+}
+
+/**
+ * Creates the regex context of an element with <all> content and
+ * feeds it the children accepted so far, so that content model
+ * errors are reported by the automaton.
+ *
+ * @param vctxt  the schema validation context
+ * @param inode  the element info
+ * @returns 0 on success and -1 on internal errors.
+ */
+static int
+xmlSchemaAllReplay(xmlSchemaValidCtxtPtr vctxt,
+		   xmlSchemaNodeInfoPtr inode)
+{
+    xmlSchemaAllModelPtr model =
+	(xmlSchemaAllModelPtr) inode->typeDef->allModel;
+    xmlSchemaAllExecPtr exec = inode->allExec;
+    xmlSchemaElementPtr decl;
+    clock_t start;
+    int i;
+
+    inode->regexCtxt = xmlRegExecPoolGet(vctxt->execPool,
+	inode->typeDef->contModel, xmlSchemaVContentModelCallback, vctxt);
+    if (inode->regexCtxt == NULL)
+	return (-1);
+    if (exec == NULL)
+	return (0);
+    start = xmlSchemaProfileStart(vctxt);
+    for (i = 0; i < exec->nbSeen; i++) {
+	decl = model->particles[exec->order[i]].decl;
+	if (xmlRegExecPushName(inode->regexCtxt, decl->name,
+		decl->targetNamespace, 0, NULL) < 0)
+	    return (-1);
+    }
+    xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_AUTOMATON, start,
+                        exec->nbSeen);
+    return (0);
 }
 
 static int
@@ -25557,7 +29105,8 @@ xmlSchemaVCheckINodeDataType(xmlSchemaValidCtxtPtr vctxt,
 			     xmlSchemaTypePtr type,
 			     const xmlChar *value)
 {
-    if (inode->flags & XML_SCHEMA_NODE_INFO_VALUE_NEEDED)
+    if ((inode->flags & XML_SCHEMA_NODE_INFO_VALUE_NEEDED) ||
+        ((vctxt->keepValues) && (inode->node != NULL)))
 	return (xmlSchemaVCheckCVCSimpleType(
 	    ACTXT_CAST vctxt, NULL,
 	    type, value, &(inode->val), 1, 1, 0));
@@ -25577,6 +29126,7 @@ xmlSchemaValidatorPopElem(xmlSchemaValidCtxtPtr vctxt)
 {
     int ret = 0;
     xmlSchemaNodeInfoPtr inode = vctxt->inode;
+    clock_t start;
 
     if (vctxt->nbAttrInfos != 0)
 	xmlSchemaClearAttrInfos(vctxt);
@@ -25614,12 +29164,27 @@ xmlSchemaValidatorPopElem(xmlSchemaValidCtxtPtr vctxt)
 	    xmlChar *values[10];
 	    int terminal, nbval = 10, nbneg;
 
+	    if ((inode->typeDef->allModel != NULL) &&
+		(inode->regexCtxt == NULL)) {
+		if ((INODE_NILLED(inode)) ||
+		    (xmlSchemaAllIsComplete(inode->typeDef->allModel,
+					    inode->allExec))) {
+		    ret = 0;
+		    goto skip_nilled;
+		}
+		if (xmlSchemaAllReplay(vctxt, inode) < 0) {
+		    VERROR_INT("xmlSchemaValidatorPopElem",
+			"failed to replay the <all> content");
+		    goto internal_error;
+		}
+	    }
 	    if (inode->regexCtxt == NULL) {
 		/*
 		* Create the regex context.
 		*/
 		inode->regexCtxt =
-		    xmlRegNewExecCtxt(inode->typeDef->contModel,
+		    xmlRegExecPoolGet(vctxt->execPool,
+		    inode->typeDef->contModel,
 		    xmlSchemaVContentModelCallback, vctxt);
 		if (inode->regexCtxt == NULL) {
 		    VERROR_INT("xmlSchemaValidatorPopElem",
@@ -25642,7 +29207,9 @@ xmlSchemaValidatorPopElem(xmlSchemaValidCtxtPtr vctxt)
 	    */
 	    xmlRegExecNextValues(inode->regexCtxt,
 		&nbval, &nbneg, &values[0], &terminal);
+	    start = xmlSchemaProfileStart(vctxt);
 	    ret = xmlRegExecPushString(inode->regexCtxt, NULL, NULL);
+	    xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_AUTOMATON, start, 1);
 	    if ((ret<0) || ((ret==0) && (!INODE_NILLED(inode)))) {
 		/*
 		* Still missing something.
@@ -25923,6 +29490,7 @@ end_elem:
     }
     if (vctxt->depth == vctxt->skipDepth)
 	vctxt->skipDepth = -1;
+    start = xmlSchemaProfileStart(vctxt);
     /*
     * Evaluate the history of XPath state objects.
     */
@@ -25971,6 +29539,7 @@ end_elem:
 		goto internal_error;
 	}
     }
+    xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_IDC, start, 0);
     /*
     * Clear the current ielem.
     * VAL TODO: Don't free the PSVI IDC tables if they are
@@ -26024,6 +29593,7 @@ xmlSchemaValidateChildElem(xmlSchemaValidCtxtPtr vctxt)
 {
     xmlSchemaNodeInfoPtr pielem;
     xmlSchemaTypePtr ptype;
+    clock_t start;
     int ret = 0;
 
     if (vctxt->depth <= 0) {
@@ -26058,7 +29628,7 @@ xmlSchemaValidateChildElem(xmlSchemaValidCtxtPtr vctxt)
 	* assigned for "anyType", so handle it explicitly.
 	* "anyType" has an unbounded, lax "any" wildcard.
 	*/
-	vctxt->inode->decl = xmlSchemaGetElem(vctxt->schema,
+	vctxt->inode->decl = xmlSchemaVGetGlobal(vctxt, XML_SCHEMA_TYPE_ELEMENT,
 	    vctxt->inode->localName,
 	    vctxt->inode->nsName);
 
@@ -26139,13 +29709,26 @@ xmlSchemaValidateChildElem(xmlSchemaValidCtxtPtr vctxt)
 		return (-1);
 	    }
 
+	    if ((ptype->allModel != NULL) && (pielem->regexCtxt == NULL)) {
+		start = xmlSchemaProfileStart(vctxt);
+		ret = xmlSchemaAllPush(vctxt, pielem, ptype->allModel);
+		xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_AUTOMATON, start, 1);
+		if (ret == 0)
+		    break;
+		if ((ret < 0) || (xmlSchemaAllReplay(vctxt, pielem) < 0)) {
+		    VERROR_INT("xmlSchemaValidateChildElem",
+			"failed to validate <all> content");
+		    return (-1);
+		}
+	    }
+
 	    regexCtxt = pielem->regexCtxt;
 	    if (regexCtxt == NULL) {
 		/*
 		* Create the regex context.
 		*/
-		regexCtxt = xmlRegNewExecCtxt(ptype->contModel,
-		    xmlSchemaVContentModelCallback, vctxt);
+		regexCtxt = xmlRegExecPoolGet(vctxt->execPool,
+		    ptype->contModel, xmlSchemaVContentModelCallback, vctxt);
 		if (regexCtxt == NULL) {
 		    VERROR_INT("xmlSchemaValidateChildElem",
 			"failed to create a regex context");
@@ -26162,13 +29745,15 @@ xmlSchemaValidateChildElem(xmlSchemaValidCtxtPtr vctxt)
 	    * particle, as defined in Element Sequence Locally Valid
 	    * (Particle) ($3.9.4)."
 	    */
-	    ret = xmlRegExecPushString2(regexCtxt,
+	    start = xmlSchemaProfileStart(vctxt);
+	    ret = xmlRegExecPushName(regexCtxt,
 		vctxt->inode->localName,
-		vctxt->inode->nsName,
+		vctxt->inode->nsName, 0,
 		vctxt->inode);
+	    xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_AUTOMATON, start, 1);
 	    if (vctxt->err == XML_SCHEMAV_INTERNAL) {
 		VERROR_INT("xmlSchemaValidateChildElem",
-		    "calling xmlRegExecPushString2()");
+		    "calling xmlRegExecPushName()");
 		return (-1);
 	    }
 	    if (ret < 0) {
@@ -26360,9 +29945,154 @@ xmlSchemaVPushText(xmlSchemaValidCtxtPtr vctxt,
     return (0);
 }
 
+#ifdef XML_SCHEMA_PARALLEL
+/*
+ * Check whether the subtree of the current element can be validated
+ * by a worker thread and defer it if so. The element was already
+ * validated against the content model of its parent.
+ *
+ * Returns 1 if the subtree was deferred, 0 if not and -1 if a memory
+ * allocation failed.
+ */
+static int
+xmlSchemaParDefer(xmlSchemaValidCtxtPtr vctxt)
+{
+    xmlSchemaParRunPtr run = vctxt->parRun;
+    xmlSchemaNodeInfoPtr inode = vctxt->inode;
+    xmlSchemaParSegmentPtr seg;
+    xmlNodePtr cur;
+    int i, count;
+
+    /*
+    * Descendants of a subtree found too small are too small as well.
+    */
+    if ((run->smallDepth >= 0) && (vctxt->depth > run->smallDepth))
+        return(0);
+    run->smallDepth = -1;
+
+    if ((inode->node == NULL) || (inode->decl == NULL) ||
+        (inode->decl->type != XML_SCHEMA_TYPE_ELEMENT) ||
+        (inode->typeDef != NULL))
+        return(0);
+    /*
+    * Identity-constraints in scope need the nodes of the subtree.
+    */
+    if (vctxt->xpathStates != NULL)
+        return(0);
+    for (i = 0; i < vctxt->depth; i++) {
+        if (vctxt->elemInfos[i]->idcMatchers != NULL)
+            return(0);
+    }
+
+    count = 1;
+    cur = inode->node->children;
+    while ((cur != NULL) && (count < run->minNodes)) {
+        if (cur->type == XML_ELEMENT_NODE) {
+            count++;
+            if (cur->children != NULL) {
+                cur = cur->children;
+                continue;
+            }
+        }
+        while ((cur != inode->node) && (cur->next == NULL))
+            cur = cur->parent;
+        if (cur == inode->node)
+            break;
+        cur = cur->next;
+    }
+    if (count < run->minNodes) {
+        run->smallDepth = vctxt->depth;
+        return(0);
+    }
+
+    /*
+    * Add the subtree and a new segment for the rest of the document.
+    */
+    if (run->nbSegs + 2 > run->sizeSegs) {
+        xmlSchemaParSegmentPtr tmp;
+        int sink = vctxt->parSink - run->segs;
+        int newSize;
+
+        newSize = xmlGrowCapacity(run->sizeSegs, sizeof(tmp[0]),
+                                  8, XML_MAX_ITEMS);
+        if (newSize < 0)
+            return(-1);
+        tmp = xmlRealloc(run->segs, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            return(-1);
+        run->segs = tmp;
+        run->sizeSegs = newSize;
+        vctxt->parSink = &tmp[sink];
+    }
+    seg = &run->segs[run->nbSegs++];
+    memset(seg, 0, sizeof(*seg));
+    seg->elem = inode->node;
+    seg->decl = inode->decl;
+    seg = &run->segs[run->nbSegs++];
+    memset(seg, 0, sizeof(*seg));
+    vctxt->parSink = seg;
+
+    return(1);
+}
+#endif /* XML_SCHEMA_PARALLEL */
+
+static int
+xmlSchemaIncCompare(const void *a, const void *b)
+{
+    size_t na = (size_t) *(const xmlNode * const *) a;
+    size_t nb = (size_t) *(const xmlNode * const *) b;
+
+    return((na < nb) ? -1 : (na > nb));
+}
+
+/*
+ * Check whether the subtree of the current element can be skipped
+ * during revalidation. The element was already validated against
+ * the content model of its parent.
+ */
+static int
+xmlSchemaIncSkip(xmlSchemaValidCtxtPtr vctxt)
+{
+    xmlSchemaIncRunPtr run = vctxt->incRun;
+    xmlSchemaNodeInfoPtr inode = vctxt->inode;
+    xmlNodePtr node = inode->node;
+
+    if (run->fullDepth >= 0) {
+        if (vctxt->depth > run->fullDepth)
+            return(0);
+        run->fullDepth = -1;
+    }
+    if ((node == NULL) ||
+        (bsearch(&node, run->nodes, run->nbNodes, sizeof(node),
+                 xmlSchemaIncCompare) != NULL)) {
+        run->fullDepth = vctxt->depth;
+        return(0);
+    }
+    if (bsearch(&node, run->path, run->nbPath, sizeof(node),
+                xmlSchemaIncCompare) != NULL) {
+        /*
+        * Identity-constraints need all nodes in their scope.
+        */
+        if ((inode->decl != NULL) &&
+            (inode->decl->type == XML_SCHEMA_TYPE_ELEMENT) &&
+            (inode->decl->idcs != NULL))
+            run->fullDepth = vctxt->depth;
+        return(0);
+    }
+    /*
+    * Types assigned by the parent, like for lax wildcards, need
+    * further processing.
+    */
+    if (inode->typeDef != NULL)
+        return(0);
+
+    return(1);
+}
+
 static int
 xmlSchemaValidateElem(xmlSchemaValidCtxtPtr vctxt)
 {
+    clock_t start;
     int ret = 0;
 
     if ((vctxt->skipDepth != -1) &&
@@ -26419,11 +30149,32 @@ xmlSchemaValidateElem(xmlSchemaValidCtxtPtr vctxt)
 		"declaration nor the type was set");
 	    goto internal_error;
 	}
+#ifdef XML_SCHEMA_PARALLEL
+	if (vctxt->parRun != NULL) {
+	    /*
+	    * Leave large subtrees to worker threads.
+	    */
+	    ret = xmlSchemaParDefer(vctxt);
+	    if (ret != 0) {
+		if (ret < 0) {
+		    xmlSchemaVErrMemory(vctxt);
+		    goto internal_error;
+		}
+		vctxt->skipDepth = vctxt->depth;
+		return (0);
+	    }
+	}
+#endif
+    } else if (vctxt->parRootDecl != NULL) {
+	/*
+	* The root of a subtree deferred by a parallel run.
+	*/
+	vctxt->inode->decl = vctxt->parRootDecl;
     } else {
 	/*
 	* Get the declaration of the validation root.
 	*/
-	vctxt->inode->decl = xmlSchemaGetElem(vctxt->schema,
+	vctxt->inode->decl = xmlSchemaVGetGlobal(vctxt, XML_SCHEMA_TYPE_ELEMENT,
 	    vctxt->inode->localName,
 	    vctxt->inode->nsName);
 	if (vctxt->inode->decl == NULL) {
@@ -26434,6 +30185,13 @@ xmlSchemaValidateElem(xmlSchemaValidCtxtPtr vctxt)
 	    goto exit;
 	}
     }
+    if ((vctxt->incRun != NULL) && (xmlSchemaIncSkip(vctxt))) {
+	/*
+	* Unmodified subtrees are skipped during revalidation.
+	*/
+	vctxt->skipDepth = vctxt->depth;
+	return (0);
+    }
 
     if (vctxt->inode->decl == NULL)
 	goto type_validation;
@@ -26443,7 +30201,9 @@ xmlSchemaValidateElem(xmlSchemaValidCtxtPtr vctxt)
 	/*
 	* Wildcards.
 	*/
+	start = xmlSchemaProfileStart(vctxt);
 	ret = xmlSchemaValidateElemWildcard(vctxt, &skip);
+	xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_WILDCARD, start, 1);
 	if (ret != 0) {
 	    if (ret < 0) {
 		VERROR_INT("xmlSchemaValidateElem",
@@ -26499,13 +30259,17 @@ type_validation:
 	    "The type definition is abstract");
 	goto exit;
     }
+    if (vctxt->profile != NULL)
+        xmlSchemaProfileNode(vctxt, vctxt->inode->typeDef, 0);
     /*
     * Evaluate IDCs. Do it here, since new IDC matchers are registered
     * during validation against the declaration. This must be done
     * _before_ attribute validation.
     */
     if (vctxt->xpathStates != NULL) {
+	start = xmlSchemaProfileStart(vctxt);
 	ret = xmlSchemaXPathEvaluate(vctxt, XML_ELEMENT_NODE);
+	xmlSchemaProfileEnd(vctxt, XML_SCHEMA_PROF_IDC, start, 1);
 	vctxt->inode->appliedXPath = 1;
 	if (ret == -1) {
 	    VERROR_INT("xmlSchemaValidateElem",
@@ -26748,31 +30512,46 @@ internal_error:
  *									*
  ************************************************************************/
 
-/*
-* Process text content.
-*/
-static void
-xmlSchemaSAXHandleText(void *ctx,
-		       const xmlChar * ch,
-		       int len)
+/**
+ * Process text content. Also called directly by the parser if the
+ * validation context is attached with #xmlSchemaValidateAttach.
+ *
+ * @param vctxt  the validation context
+ * @param cdata  whether the text is part of a CDATA section
+ * @param ch  the text
+ * @param len  length of the text
+ */
+void
+xmlSchemaValidateText(xmlSchemaValidCtxt *vctxt, int cdata,
+                      const xmlChar *ch, int len)
 {
-    xmlSchemaValidCtxtPtr vctxt = (xmlSchemaValidCtxtPtr) ctx;
-
     if (vctxt->depth < 0)
 	return;
     if ((vctxt->skipDepth != -1) && (vctxt->depth >= vctxt->skipDepth))
 	return;
     if (vctxt->inode->flags & XML_SCHEMA_ELEM_INFO_EMPTY)
 	vctxt->inode->flags ^= XML_SCHEMA_ELEM_INFO_EMPTY;
-    if (xmlSchemaVPushText(vctxt, XML_TEXT_NODE, ch, len,
+    if (xmlSchemaVPushText(vctxt,
+        cdata ? XML_CDATA_SECTION_NODE : XML_TEXT_NODE, ch, len,
 	XML_SCHEMA_PUSH_TEXT_VOLATILE, NULL) == -1) {
-	VERROR_INT("xmlSchemaSAXHandleCDataSection",
+	VERROR_INT("xmlSchemaValidateText",
 	    "calling xmlSchemaVPushText()");
 	vctxt->err = -1;
 	xmlStopParser(vctxt->parserCtxt);
     }
 }
 
+/*
+* Process text content.
+*/
+static void
+xmlSchemaSAXHandleText(void *ctx,
+		       const xmlChar * ch,
+		       int len)
+{
+    xmlSchemaValidateText((xmlSchemaValidCtxtPtr) ctx, 0, ch, len);
+}
+
 /*
 * Process CDATA content.
 */
@@ -26781,21 +30560,7 @@ xmlSchemaSAXHandleCDataSection(void *ctx,
 			     const xmlChar * ch,
 			     int len)
 {
-    xmlSchemaValidCtxtPtr vctxt = (xmlSchemaValidCtxtPtr) ctx;
-
-    if (vctxt->depth < 0)
-	return;
-    if ((vctxt->skipDepth != -1) && (vctxt->depth >= vctxt->skipDepth))
-	return;
-    if (vctxt->inode->flags & XML_SCHEMA_ELEM_INFO_EMPTY)
-	vctxt->inode->flags ^= XML_SCHEMA_ELEM_INFO_EMPTY;
-    if (xmlSchemaVPushText(vctxt, XML_CDATA_SECTION_NODE, ch, len,
-	XML_SCHEMA_PUSH_TEXT_VOLATILE, NULL) == -1) {
-	VERROR_INT("xmlSchemaSAXHandleCDataSection",
-	    "calling xmlSchemaVPushText()");
-	vctxt->err = -1;
-	xmlStopParser(vctxt->parserCtxt);
-    }
+    xmlSchemaValidateText((xmlSchemaValidCtxtPtr) ctx, 1, ch, len);
 }
 
 static void
@@ -26811,25 +30576,100 @@ xmlSchemaSAXHandleReference(void *ctx ATTRIBUTE_UNUSED,
     /* SAX VAL TODO: What to do here? */
 }
 
-static void
-xmlSchemaSAXHandleStartElementNs(void *ctx,
-				 const xmlChar * localname,
-				 const xmlChar * prefix ATTRIBUTE_UNUSED,
-				 const xmlChar * URI,
-				 int nb_namespaces,
-				 const xmlChar ** namespaces,
-				 int nb_attributes,
-				 int nb_defaulted ATTRIBUTE_UNUSED,
-				 const xmlChar ** attributes)
+/*
+* Copy the attribute values of a start tag to a buffer which is
+* reused for every element. The attribute infos only refer to the
+* values until they are cleared at the end of the start tag.
+*
+* libxml2 differs from normal SAX here in that it escapes all ampersands
+* as &#38; instead of delivering the raw converted string. Changing the
+* behavior at this point would break applications that use this API, so
+* we are forced to work around it and change any &#38; to a literal
+* ampersand.
+*/
+static xmlChar *
+xmlSchemaCopyAttrValues(xmlSchemaValidCtxtPtr vctxt, int nbAttributes,
+                        const xmlChar **attributes)
+{
+    xmlChar *value;
+    size_t size = 0;
+    int i, j, k, valueLen;
+
+    for (i = 0, j = 0; i < nbAttributes; i++, j += 5)
+        size += attributes[j+4] - attributes[j+3] + 1;
+
+    if (size > vctxt->sizeAttrValues) {
+        size_t newSize = vctxt->sizeAttrValues;
+
+        if (newSize == 0)
+            newSize = 256;
+        while (newSize < size) {
+            if (newSize > SIZE_MAX / 2) {
+                newSize = size;
+                break;
+            }
+            newSize *= 2;
+        }
+        xmlFree(vctxt->attrValues);
+        vctxt->sizeAttrValues = 0;
+        vctxt->attrValues = xmlMalloc(newSize);
+        if (vctxt->attrValues == NULL)
+            return(NULL);
+        vctxt->sizeAttrValues = newSize;
+    }
+
+    value = vctxt->attrValues;
+    for (i = 0, j = 0; i < nbAttributes; i++, j += 5) {
+        const xmlChar *cur = attributes[j+3];
+
+        valueLen = attributes[j+4] - cur;
+        for (k = 0; k < valueLen; value++) {
+            if (k < valueLen - 4 &&
+                cur[k+0] == '&' &&
+                cur[k+1] == '#' &&
+                cur[k+2] == '3' &&
+                cur[k+3] == '8' &&
+                cur[k+4] == ';') {
+                *value = '&';
+                k += 5;
+            } else {
+                *value = cur[k];
+                k++;
+            }
+        }
+        *value++ = '\0';
+    }
+
+    return(vctxt->attrValues);
+}
+
+/**
+ * Process a start tag. Also called directly by the parser if the
+ * validation context is attached with #xmlSchemaValidateAttach.
+ * The arrays have the same layout as the arguments of the SAX2
+ * startElementNs callback.
+ *
+ * @param vctxt  the validation context
+ * @param localname  the local name of the element
+ * @param URI  the namespace URI of the element (optional)
+ * @param nb_namespaces  number of namespace declarations
+ * @param namespaces  prefixes and URIs of the declarations
+ * @param nb_attributes  number of attributes
+ * @param attributes  attributes with 5 entries each
+ */
+void
+xmlSchemaValidateStartTag(xmlSchemaValidCtxt *vctxt,
+                          const xmlChar *localname,
+                          const xmlChar *URI,
+                          int nb_namespaces,
+                          const xmlChar **namespaces,
+                          int nb_attributes,
+                          const xmlChar **attributes)
 {
-    xmlSchemaValidCtxtPtr vctxt = (xmlSchemaValidCtxtPtr) ctx;
     int ret;
     xmlSchemaNodeInfoPtr ielem;
     int i, j;
 
-    /*
-    * SAX VAL TODO: What to do with nb_defaulted?
-    */
     /*
     * Skip elements if inside a "skip" wildcard or invalid.
     */
@@ -26840,7 +30680,7 @@ xmlSchemaSAXHandleStartElementNs(void *ctx,
     * Push the element.
     */
     if (xmlSchemaValidatorPushElem(vctxt) == -1) {
-	VERROR_INT("xmlSchemaSAXHandleStartElementNs",
+	VERROR_INT("xmlSchemaValidateStartTag",
 	    "calling xmlSchemaValidatorPushElem()");
 	goto internal_error;
     }
@@ -26903,50 +30743,26 @@ xmlSchemaSAXHandleStartElementNs(void *ctx,
     * attributes yet.
     */
     if (nb_attributes != 0) {
-	int valueLen, k, l;
 	xmlChar *value;
 
-        for (j = 0, i = 0; i < nb_attributes; i++, j += 5) {
-	    /*
-	    * Duplicate the value, changing any &#38; to a literal ampersand.
-	    *
-	    * libxml2 differs from normal SAX here in that it escapes all ampersands
-	    * as &#38; instead of delivering the raw converted string. Changing the
-	    * behavior at this point would break applications that use this API, so
-	    * we are forced to work around it.
-	    */
-	    valueLen = attributes[j+4] - attributes[j+3];
-	    value = xmlMalloc(valueLen + 1);
-	    if (value == NULL) {
-		xmlSchemaVErrMemory(vctxt);
-		goto internal_error;
-	    }
-	    for (k = 0, l = 0; k < valueLen; l++) {
-		if (k < valueLen - 4 &&
-		    attributes[j+3][k+0] == '&' &&
-		    attributes[j+3][k+1] == '#' &&
-		    attributes[j+3][k+2] == '3' &&
-		    attributes[j+3][k+3] == '8' &&
-		    attributes[j+3][k+4] == ';') {
-		    value[l] = '&';
-		    k += 5;
-		} else {
-		    value[l] = attributes[j+3][k];
-		    k++;
-		}
-	    }
-	    value[l] = '\0';
+        value = xmlSchemaCopyAttrValues(vctxt, nb_attributes, attributes);
+        if (value == NULL) {
+            xmlSchemaVErrMemory(vctxt);
+            goto internal_error;
+        }
+        for (j = 0, i = 0; i < nb_attributes; i++, j += 5) {
 	    /*
 	    * TODO: Set the node line.
 	    */
 	    ret = xmlSchemaValidatorPushAttribute(vctxt,
 		NULL, ielem->nodeLine, attributes[j], attributes[j+2], 0,
-		value, 1);
+		value, 0);
 	    if (ret == -1) {
-		VERROR_INT("xmlSchemaSAXHandleStartElementNs",
+		VERROR_INT("xmlSchemaValidateStartTag",
 		    "calling xmlSchemaValidatorPushAttribute()");
 		goto internal_error;
 	    }
+            value += strlen((char *) value) + 1;
 	}
     }
     /*
@@ -26955,7 +30771,7 @@ xmlSchemaSAXHandleStartElementNs(void *ctx,
     ret = xmlSchemaValidateElem(vctxt);
     if (ret != 0) {
 	if (ret == -1) {
-	    VERROR_INT("xmlSchemaSAXHandleStartElementNs",
+	    VERROR_INT("xmlSchemaValidateStartTag",
 		"calling xmlSchemaValidateElem()");
 	    goto internal_error;
 	}
@@ -26963,19 +30779,47 @@ xmlSchemaSAXHandleStartElementNs(void *ctx,
     }
 
 exit:
+    /* The attribute values are only valid during this call */
+    xmlSchemaClearAttrInfos(vctxt);
     return;
 internal_error:
+    xmlSchemaClearAttrInfos(vctxt);
     vctxt->err = -1;
     xmlStopParser(vctxt->parserCtxt);
 }
 
 static void
-xmlSchemaSAXHandleEndElementNs(void *ctx,
-			       const xmlChar * localname ATTRIBUTE_UNUSED,
-			       const xmlChar * prefix ATTRIBUTE_UNUSED,
-			       const xmlChar * URI ATTRIBUTE_UNUSED)
+xmlSchemaSAXHandleStartElementNs(void *ctx,
+				 const xmlChar * localname,
+				 const xmlChar * prefix ATTRIBUTE_UNUSED,
+				 const xmlChar * URI,
+				 int nb_namespaces,
+				 const xmlChar ** namespaces,
+				 int nb_attributes,
+				 int nb_defaulted ATTRIBUTE_UNUSED,
+				 const xmlChar ** attributes)
+{
+    /*
+    * SAX VAL TODO: What to do with nb_defaulted?
+    */
+    xmlSchemaValidateStartTag((xmlSchemaValidCtxtPtr) ctx, localname, URI,
+                              nb_namespaces, namespaces,
+                              nb_attributes, attributes);
+}
+
+/**
+ * Process an end tag. Also called directly by the parser if the
+ * validation context is attached with #xmlSchemaValidateAttach.
+ *
+ * @param vctxt  the validation context
+ * @param localname  the local name of the element
+ * @param URI  the namespace URI of the element (optional)
+ */
+void
+xmlSchemaValidateEndTag(xmlSchemaValidCtxt *vctxt,
+                        const xmlChar *localname,
+                        const xmlChar *URI)
 {
-    xmlSchemaValidCtxtPtr vctxt = (xmlSchemaValidCtxtPtr) ctx;
     int res;
 
     /*
@@ -26993,13 +30837,13 @@ xmlSchemaSAXHandleEndElementNs(void *ctx,
     */
     if ((!xmlStrEqual(vctxt->inode->localName, localname)) ||
 	(!xmlStrEqual(vctxt->inode->nsName, URI))) {
-	VERROR_INT("xmlSchemaSAXHandleEndElementNs",
+	VERROR_INT("xmlSchemaValidateEndTag",
 	    "elem pop mismatch");
     }
     res = xmlSchemaValidatorPopElem(vctxt);
     if (res != 0) {
 	if (res < 0) {
-	    VERROR_INT("xmlSchemaSAXHandleEndElementNs",
+	    VERROR_INT("xmlSchemaValidateEndTag",
 		"calling xmlSchemaValidatorPopElem()");
 	    goto internal_error;
 	}
@@ -27012,6 +30856,15 @@ internal_error:
     xmlStopParser(vctxt->parserCtxt);
 }
 
+static void
+xmlSchemaSAXHandleEndElementNs(void *ctx,
+			       const xmlChar * localname,
+			       const xmlChar * prefix ATTRIBUTE_UNUSED,
+			       const xmlChar * URI)
+{
+    xmlSchemaValidateEndTag((xmlSchemaValidCtxtPtr) ctx, localname, URI);
+}
+
 /************************************************************************
  *									*
  *			Validation interfaces				*
@@ -27021,6 +30874,10 @@ internal_error:
 /**
  * Create an XML Schemas validation context based on the given schema.
  *
+ * A validation context must only be used by one thread at a time,
+ * but the schema can be shared by contexts in other threads. See
+ * #xmlSchemaNewValidCtxtPool to reuse contexts.
+ *
  * @param schema  a precompiled XML Schemas
  * @returns the validation context or NULL in case of error
  */
@@ -27047,6 +30904,8 @@ xmlSchemaNewValidCtxt(xmlSchema *schema)
         return(NULL);
     }
     ret->schema = schema;
+    /* The pool is optional, validation works without it */
+    ret->execPool = xmlRegExecPoolCreate();
     return (ret);
 }
 
@@ -27120,20 +30979,15 @@ xmlSchemaClearValidCtxt(xmlSchemaValidCtxtPtr vctxt)
 	    xmlFree(item->keys);
 	    xmlFree(item);
 	}
-	xmlFree(vctxt->idcNodes);
-	vctxt->idcNodes = NULL;
+	/* Keep the array for the next run. */
 	vctxt->nbIdcNodes = 0;
-	vctxt->sizeIdcNodes = 0;
     }
 
     if (vctxt->idcKeys != NULL) {
 	int i;
 	for (i = 0; i < vctxt->nbIdcKeys; i++)
 	    xmlSchemaIDCFreeKey(vctxt->idcKeys[i]);
-	xmlFree(vctxt->idcKeys);
-	vctxt->idcKeys = NULL;
 	vctxt->nbIdcKeys = 0;
-	vctxt->sizeIdcKeys = 0;
     }
 
     /*
@@ -27258,6 +31112,7 @@ xmlSchemaFreeValidCtxt(xmlSchemaValidCtxt *ctxt)
 	}
 	xmlFree(ctxt->attrInfos);
     }
+    xmlFree(ctxt->attrValues);
     if (ctxt->elemInfos != NULL) {
 	int i;
 	xmlSchemaNodeInfoPtr ei;
@@ -27271,15 +31126,225 @@ xmlSchemaFreeValidCtxt(xmlSchemaValidCtxt *ctxt)
 	}
 	xmlFree(ctxt->elemInfos);
     }
+    xmlRegExecPoolFree(ctxt->execPool);
     if (ctxt->nodeQNames != NULL)
 	xmlSchemaItemListFree(ctxt->nodeQNames);
     if (ctxt->dict != NULL)
 	xmlDictFree(ctxt->dict);
     if (ctxt->filename != NULL)
 	xmlFree(ctxt->filename);
+    xmlFree(ctxt->memBudget);
+    xmlErrorPolicyFree(ctxt->errorPolicy);
+    xmlSchemaFreeValidProfile(ctxt->profile);
+    xmlSchemaFreeKeptValues(ctxt);
+    xmlFree(ctxt->values);
     xmlFree(ctxt);
 }
 
+/*
+ * A pool of validation contexts for a single schema which keeps the
+ * memory of element and attribute infos and IDC tables allocated by
+ * earlier validation runs.
+ */
+struct _xmlSchemaValidCtxtPool {
+    xmlMutex mutex;
+    xmlSchemaPtr schema;
+    xmlSchemaValidCtxtPtr *ctxts;
+    int nbCtxts;
+    int maxCtxts;
+};
+
+/**
+ * Create a pool of validation contexts for a schema.
+ *
+ * Validating many small documents with fresh contexts spends a
+ * considerable amount of time allocating and growing the stacks of
+ * element and attribute infos and the IDC node and key tables.
+ * Contexts released into a pool retain this memory and are handed
+ * out again by #xmlSchemaValidCtxtPoolAcquire.
+ *
+ * The pool can be shared between threads. The schema isn't owned
+ * by the pool and must not be freed before the pool and all
+ * contexts acquired from it.
+ *
+ * @since 2.16.0
+ *
+ * @param schema  a precompiled XML Schemas
+ * @param maxSize  maximum number of idle contexts kept in the pool
+ * @returns the new pool or NULL in case of error.
+ */
+xmlSchemaValidCtxtPool *
+xmlSchemaNewValidCtxtPool(xmlSchema *schema, int maxSize) {
+    xmlSchemaValidCtxtPool *pool;
+
+    if (schema == NULL)
+        return(NULL);
+    if (maxSize < 0)
+        maxSize = 0;
+
+    pool = xmlMalloc(sizeof(*pool));
+    if (pool == NULL) {
+        xmlSchemaVErrMemory(NULL);
+        return(NULL);
+    }
+    memset(pool, 0, sizeof(*pool));
+
+    if (maxSize > 0) {
+        pool->ctxts = xmlMalloc(maxSize * sizeof(pool->ctxts[0]));
+        if (pool->ctxts == NULL) {
+            xmlSchemaVErrMemory(NULL);
+            xmlFree(pool);
+            return(NULL);
+        }
+    }
+    pool->schema = schema;
+    pool->maxCtxts = maxSize;
+    xmlInitMutex(&pool->mutex);
+
+    return(pool);
+}
+
+/**
+ * Free a validation context pool including all idle contexts.
+ * Contexts which are still in use must be freed with
+ * #xmlSchemaFreeValidCtxt.
+ *
+ * @since 2.16.0
+ *
+ * @param pool  the pool (optional)
+ */
+void
+xmlSchemaFreeValidCtxtPool(xmlSchemaValidCtxtPool *pool) {
+    int i;
+
+    if (pool == NULL)
+        return;
+
+    for (i = 0; i < pool->nbCtxts; i++)
+        xmlSchemaFreeValidCtxt(pool->ctxts[i]);
+    xmlFree(pool->ctxts);
+    xmlCleanupMutex(&pool->mutex);
+    xmlFree(pool);
+}
+
+/**
+ * Get a validation context from a pool. If the pool is empty, a new
+ * context is created.
+ *
+ * The context is in the same state as a context returned by
+ * #xmlSchemaNewValidCtxt for the schema of the pool. It must be
+ * returned with #xmlSchemaValidCtxtPoolRelease or freed with
+ * #xmlSchemaFreeValidCtxt.
+ *
+ * @since 2.16.0
+ *
+ * @param pool  the pool
+ * @returns a validation context or NULL in case of error.
+ */
+xmlSchemaValidCtxt *
+xmlSchemaValidCtxtPoolAcquire(xmlSchemaValidCtxtPool *pool) {
+    xmlSchemaValidCtxtPtr ctxt = NULL;
+
+    if (pool == NULL)
+        return(NULL);
+
+    xmlMutexLock(&pool->mutex);
+    if (pool->nbCtxts > 0)
+        ctxt = pool->ctxts[--pool->nbCtxts];
+    xmlMutexUnlock(&pool->mutex);
+
+    if (ctxt == NULL)
+        ctxt = xmlSchemaNewValidCtxt(pool->schema);
+
+    return(ctxt);
+}
+
+/**
+ * Reset a validation context to its initial state, keeping the
+ * memory of element and attribute infos, IDC tables and XPath
+ * state objects.
+ *
+ * @param vctxt  the schema validation context
+ * @returns 0 on success or -1 in case of error.
+ */
+static int
+xmlSchemaValidCtxtPoolReset(xmlSchemaValidCtxtPtr vctxt) {
+    xmlSchemaClearValidCtxt(vctxt);
+    if (vctxt->dict == NULL)
+        return(-1);
+
+    /*
+    * The parser context is only used for XSI assembly and carries
+    * the error handlers.
+    */
+    if (vctxt->pctxt != NULL) {
+        xmlSchemaFreeParserCtxt(vctxt->pctxt);
+        vctxt->pctxt = NULL;
+    }
+    xmlFree(vctxt->memBudget);
+    vctxt->memBudget = NULL;
+    xmlErrorPolicyFree(vctxt->errorPolicy);
+    vctxt->errorPolicy = NULL;
+
+    vctxt->errCtxt = NULL;
+    vctxt->error = NULL;
+    vctxt->warning = NULL;
+    vctxt->serror = NULL;
+    vctxt->locFunc = NULL;
+    vctxt->locCtxt = NULL;
+    vctxt->input = NULL;
+    vctxt->enc = XML_CHAR_ENCODING_NONE;
+    vctxt->sax = NULL;
+    vctxt->parserCtxt = NULL;
+    vctxt->user_data = NULL;
+    vctxt->node = NULL;
+    vctxt->cur = NULL;
+    vctxt->inode = NULL;
+    vctxt->options = 0;
+    vctxt->err = 0;
+    vctxt->nberrors = 0;
+    vctxt->parallelThreads = 0;
+    vctxt->parallelMinNodes = 0;
+    xmlSchemaFreeValidProfile(vctxt->profile);
+    vctxt->profile = NULL;
+    xmlSchemaFreeKeptValues(vctxt);
+    vctxt->keepValues = 0;
+
+    return(0);
+}
+
+/**
+ * Return a validation context to a pool. The context is reset and
+ * all settings like options, error handlers, the locator or the
+ * memory limit are cleared. If the pool is full or the context
+ * wasn't acquired from this pool, the context is freed.
+ *
+ * @since 2.16.0
+ *
+ * @param pool  the pool
+ * @param ctxt  a validation context (optional)
+ */
+void
+xmlSchemaValidCtxtPoolRelease(xmlSchemaValidCtxtPool *pool,
+                              xmlSchemaValidCtxt *ctxt) {
+    if (ctxt == NULL)
+        return;
+    if ((pool == NULL) || (ctxt->schema != pool->schema) ||
+        (xmlSchemaValidCtxtPoolReset(ctxt) < 0)) {
+        xmlSchemaFreeValidCtxt(ctxt);
+        return;
+    }
+
+    xmlMutexLock(&pool->mutex);
+    if (pool->nbCtxts < pool->maxCtxts) {
+        pool->ctxts[pool->nbCtxts++] = ctxt;
+        ctxt = NULL;
+    }
+    xmlMutexUnlock(&pool->mutex);
+
+    xmlSchemaFreeValidCtxt(ctxt);
+}
+
 /**
  * Check if any error was detected during validation.
  *
@@ -27379,20 +31444,14 @@ xmlSchemaSetValidOptions(xmlSchemaValidCtxt *ctxt,
 			 int options)
 
 {
-    int i;
-
     if (ctxt == NULL)
 	return (-1);
     /*
-    * WARNING: Change the start value if adding to the
+    * WARNING: Update the mask if adding to the
     * xmlSchemaValidOption.
-    * TODO: Is there an other, more easy to maintain,
-    * way?
     */
-    for (i = 1; i < (int) sizeof(int) * 8; i++) {
-        if (options & 1<<i)
-	    return (-1);
-    }
+    if (options & ~XML_SCHEMA_VAL_VC_I_CREATE)
+        return (-1);
     ctxt->options = options;
     return (0);
 }
@@ -27413,6 +31472,31 @@ xmlSchemaValidCtxtGetOptions(xmlSchemaValidCtxt *ctxt)
 	return (ctxt->options);
 }
 
+/*
+ * Return the namespace URI of a node in the tree, interned in the
+ * dictionary of the schema if possible, so that it compares equal to
+ * the target namespaces by address. Namespaces mostly repeat, so the
+ * last URI is cached by namespace ID.
+ */
+static const xmlChar *
+xmlSchemaWalkNsName(xmlSchemaValidCtxtPtr vctxt, const xmlNs *ns)
+{
+    const xmlChar *name;
+    int id;
+
+    if (ns == NULL)
+        return(NULL);
+    id = xmlNsIdCacheGet(&vctxt->walkNsIds, ns);
+    if ((id != 0) && (id == vctxt->walkNsId))
+        return(vctxt->walkNsName);
+    name = xmlDictExists(vctxt->schema->dict, ns->href, -1);
+    if (name == NULL)
+        return(ns->href);
+    vctxt->walkNsId = id;
+    vctxt->walkNsName = name;
+    return(name);
+}
+
 static int
 xmlSchemaVDocWalk(xmlSchemaValidCtxtPtr vctxt)
 {
@@ -27434,6 +31518,10 @@ xmlSchemaVDocWalk(xmlSchemaValidCtxtPtr vctxt)
     }
     vctxt->depth = -1;
     vctxt->validationRoot = valRoot;
+    xmlNsIdCacheInit(&vctxt->walkNsIds,
+                     (vctxt->doc != NULL) ? vctxt->doc->dict : NULL);
+    vctxt->walkNsId = 0;
+    vctxt->walkNsName = NULL;
     node = valRoot;
     while (node != NULL) {
 	if ((vctxt->skipDepth != -1) && (vctxt->depth >= vctxt->skipDepth))
@@ -27450,8 +31538,7 @@ xmlSchemaVDocWalk(xmlSchemaValidCtxtPtr vctxt)
 	    ielem->node = node;
 	    ielem->nodeLine = node->line;
 	    ielem->localName = node->name;
-	    if (node->ns != NULL)
-		ielem->nsName = node->ns->href;
+	    ielem->nsName = xmlSchemaWalkNsName(vctxt, node->ns);
 	    ielem->flags |= XML_SCHEMA_ELEM_INFO_EMPTY;
 	    /*
 	    * Register attributes.
@@ -27464,10 +31551,7 @@ xmlSchemaVDocWalk(xmlSchemaValidCtxtPtr vctxt)
 		do {
                     xmlChar *content;
 
-		    if (attr->ns != NULL)
-			nsName = attr->ns->href;
-		    else
-			nsName = NULL;
+		    nsName = xmlSchemaWalkNsName(vctxt, attr->ns);
                     content = xmlNodeListGetString(attr->doc,
                                                    attr->children, 1);
 		    ret = xmlSchemaValidatorPushAttribute(vctxt,
@@ -27592,9 +31676,11 @@ xmlSchemaPreRun(xmlSchemaValidCtxtPtr vctxt) {
     */
     vctxt->err = 0;
     vctxt->nberrors = 0;
+    xmlErrorPolicyReset(vctxt->errorPolicy);
     vctxt->depth = -1;
     vctxt->skipDepth = -1;
     vctxt->hasKeyrefs = 0;
+    xmlSchemaFreeKeptValues(vctxt);
 #ifdef ENABLE_IDC_NODE_TABLES_TEST
     vctxt->createIDCNodeTables = 1;
 #else
@@ -27640,8 +31726,19 @@ xmlSchemaPreRun(xmlSchemaValidCtxtPtr vctxt) {
     * Augment the IDC definitions for the main schema and all imported ones
     * NOTE: main schema if the first in the imported list
     */
-    xmlHashScan(vctxt->schema->schemasImports, xmlSchemaAugmentImportedIDC,
-                vctxt);
+    if (vctxt->schema->lazyImports != NULL) {
+        xmlSchemaLazyImportsPtr lazy = vctxt->schema->lazyImports;
+
+        xmlMutexLock(&lazy->lock);
+        xmlHashScan(vctxt->schema->schemasImports,
+                    xmlSchemaAugmentImportedIDC, vctxt);
+        vctxt->lazyAugmented =
+            (lazy->loaded != NULL) ? lazy->loaded->nbItems : 0;
+        xmlMutexUnlock(&lazy->lock);
+    } else {
+        xmlHashScan(vctxt->schema->schemasImports,
+                    xmlSchemaAugmentImportedIDC, vctxt);
+    }
 
     return(0);
 }
@@ -27657,18 +31754,200 @@ xmlSchemaPostRun(xmlSchemaValidCtxtPtr vctxt) {
     xmlSchemaClearValidCtxt(vctxt);
 }
 
+#ifdef XML_SCHEMA_PARALLEL
+static int
+xmlSchemaVStart(xmlSchemaValidCtxtPtr vctxt);
+
+typedef struct {
+    xmlSchemaParRunPtr run;
+    xmlSchemaValidCtxtPtr main;
+    xmlSchemaValidCtxtPtr ctxt;
+} xmlSchemaParWorker;
+
+static void
+xmlSchemaParWorkerRun(void *arg) {
+    xmlSchemaParWorker *worker = (xmlSchemaParWorker *) arg;
+    xmlSchemaParRunPtr run = worker->run;
+    xmlSchemaValidCtxtPtr ctxt = worker->ctxt;
+    xmlSchemaParSegmentPtr seg;
+    int i;
+
+    while (1) {
+        xmlMutexLock(&run->lock);
+        i = run->next;
+        while ((i < run->nbSegs) && (run->segs[i].elem == NULL))
+            i++;
+        run->next = (i < run->nbSegs) ? i + 1 : i;
+        xmlMutexUnlock(&run->lock);
+        if (i >= run->nbSegs)
+            break;
+        seg = &run->segs[i];
+
+        /* The filename is freed after each run. */
+        if (worker->main->filename != NULL) {
+            ctxt->filename = xmlMemStrdup(worker->main->filename);
+            if (ctxt->filename == NULL) {
+                seg->noMemory = 1;
+                seg->ret = -1;
+                continue;
+            }
+        }
+        ctxt->parSink = seg;
+        ctxt->parRootDecl = seg->decl;
+        ctxt->doc = seg->elem->doc;
+        ctxt->node = seg->elem;
+        ctxt->validationRoot = seg->elem;
+        seg->ret = xmlSchemaVStart(ctxt);
+        seg->nberrors = ctxt->nberrors;
+        ctxt->parSink = NULL;
+        ctxt->parRootDecl = NULL;
+    }
+}
+
+/*
+ * Validate a document, leaving large independent subtrees to worker
+ * threads. The calling thread first walks the document, skipping
+ * the subtrees, then validates subtrees along with the workers.
+ * Errors are reported in document order at the end.
+ */
+static int
+xmlSchemaVDocWalkParallel(xmlSchemaValidCtxtPtr vctxt)
+{
+    xmlSchemaParRun run;
+    xmlSchemaParWorker *workers = NULL;
+    xmlTaskGroup *group;
+    int nbWorkers = 0, nbDeferred, i, j, ret;
+
+    memset(&run, 0, sizeof(run));
+    run.minNodes = vctxt->parallelMinNodes;
+    run.smallDepth = -1;
+    run.segs = xmlMalloc(8 * sizeof(run.segs[0]));
+    if (run.segs == NULL) {
+        xmlSchemaVErrMemory(vctxt);
+        return(-1);
+    }
+    run.sizeSegs = 8;
+    run.nbSegs = 1;
+    memset(&run.segs[0], 0, sizeof(run.segs[0]));
+    xmlInitMutex(&run.lock);
+    xmlInitMutex(&run.idLock);
+
+    vctxt->parRun = &run;
+    vctxt->parSink = &run.segs[0];
+    vctxt->parIdLock = &run.idLock;
+    ret = xmlSchemaVDocWalk(vctxt);
+    vctxt->parRun = NULL;
+    vctxt->parSink = NULL;
+
+    nbDeferred = (run.nbSegs - 1) / 2;
+    if (nbDeferred > 0) {
+        nbWorkers = vctxt->parallelThreads;
+        if (nbWorkers > nbDeferred)
+            nbWorkers = nbDeferred;
+        workers = xmlMalloc(nbWorkers * sizeof(workers[0]));
+        if (workers == NULL) {
+            nbWorkers = 0;
+            run.segs[0].noMemory = 1;
+        }
+    }
+    for (i = 0; i < nbWorkers; i++) {
+        xmlSchemaParWorker *worker = &workers[i];
+        xmlSchemaValidCtxtPtr ctxt;
+
+        ctxt = xmlSchemaNewValidCtxt(vctxt->schema);
+        if (ctxt != NULL) {
+            ctxt->options = vctxt->options;
+            ctxt->parIdLock = &run.idLock;
+        }
+        worker->run = &run;
+        worker->main = vctxt;
+        worker->ctxt = ctxt;
+    }
+
+    /* The calling thread handles subtrees as well. */
+    group = xmlNewTaskGroup();
+    for (i = 1; i < nbWorkers; i++) {
+        if (workers[i].ctxt != NULL)
+            xmlTaskGroupSubmit(group, xmlSchemaParWorkerRun, &workers[i]);
+    }
+    if ((nbWorkers > 0) && (workers[0].ctxt != NULL))
+        xmlSchemaParWorkerRun(&workers[0]);
+    xmlFreeTaskGroup(group);
+    /*
+    * Subtrees left over if contexts couldn't be created.
+    */
+    for (i = 0; i < nbWorkers; i++) {
+        if (workers[i].ctxt != NULL) {
+            if (run.next < run.nbSegs)
+                xmlSchemaParWorkerRun(&workers[i]);
+            break;
+        }
+    }
+
+    for (i = 0; i < run.nbSegs; i++) {
+        xmlSchemaParSegmentPtr seg = &run.segs[i];
+
+        for (j = 0; j < seg->nbErrors; j++) {
+            xmlSchemaParReplayError(vctxt, &seg->errors[j]);
+            xmlResetError(&seg->errors[j]);
+        }
+        xmlFree(seg->errors);
+        if (seg->elem != NULL) {
+            /* Not validated at all if no context could be created. */
+            if (i >= run.next)
+                seg->noMemory = 1;
+            vctxt->nberrors += seg->nberrors;
+            if (seg->ret < 0)
+                ret = -1;
+        }
+        if (seg->noMemory) {
+            xmlSchemaVErrMemory(vctxt);
+            ret = -1;
+        }
+    }
+
+    for (i = 0; i < nbWorkers; i++)
+        xmlSchemaFreeValidCtxt(workers[i].ctxt);
+    xmlFree(workers);
+    xmlFree(run.segs);
+    xmlCleanupMutex(&run.lock);
+    xmlCleanupMutex(&run.idLock);
+    vctxt->parIdLock = NULL;
+
+    return(ret);
+}
+#endif /* XML_SCHEMA_PARALLEL */
+
 static int
 xmlSchemaVStart(xmlSchemaValidCtxtPtr vctxt)
 {
+    xmlMemBudget *oldBudget;
+    double start;
     int ret = 0;
 
-    if (xmlSchemaPreRun(vctxt) < 0)
+    xmlMemBudgetReset(vctxt->memBudget);
+    oldBudget = xmlMemBudgetEnter(vctxt->memBudget);
+
+    if (xmlSchemaPreRun(vctxt) < 0) {
+        xmlMemBudgetLeave(oldBudget);
         return(-1);
+    }
+
+    XML_TRACE_BEGIN(valid, XML_TRACE_VALID_START, "xsd", start);
 
     if (vctxt->doc != NULL) {
 	/*
 	 * Tree validation.
 	 */
+#ifdef XML_SCHEMA_PARALLEL
+        if ((vctxt->parallelThreads > 1) && (!vctxt->xsiAssemble) &&
+            (vctxt->incRun == NULL) &&
+            (vctxt->memBudget == NULL) && (vctxt->profile == NULL) &&
+            (!vctxt->keepValues) &&
+            ((vctxt->options & XML_SCHEMA_VAL_VC_I_CREATE) == 0))
+            ret = xmlSchemaVDocWalkParallel(vctxt);
+        else
+#endif
 	ret = xmlSchemaVDocWalk(vctxt);
 #ifdef LIBXML_READER_ENABLED
     } else if (vctxt->reader != NULL) {
@@ -27691,6 +31970,10 @@ xmlSchemaVStart(xmlSchemaValidCtxtPtr vctxt)
     }
 
     xmlSchemaPostRun(vctxt);
+    xmlMemBudgetLeave(oldBudget);
+
+    XML_TRACE_END(valid, XML_TRACE_VALID_END, "xsd", -1L, start);
+
     if (ret == 0)
 	ret = vctxt->err;
     return (ret);
@@ -27746,6 +32029,106 @@ xmlSchemaValidateDoc(xmlSchemaValidCtxt *ctxt, xmlDoc *doc)
     return (xmlSchemaVStart(ctxt));
 }
 
+/**
+ * Revalidate a document tree after some of its subtrees were
+ * modified. Only the modified subtrees are validated completely.
+ * Their ancestors are validated against their declarations and
+ * content models, other elements only against the content models
+ * of their parents. Subtrees in the scope of identity-constraints
+ * of an ancestor are validated completely.
+ *
+ * The rest of the document must be unchanged since it was last
+ * validated with the same schema. Errors are only reported for the
+ * parts which are validated again.
+ *
+ * Nodes which aren't elements are replaced with their parent
+ * element. After removing nodes, pass the former parent. If the
+ * document element was replaced, pass the new one or the document.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  a schema validation context
+ * @param doc  a parsed document tree
+ * @param nodes  the modified nodes
+ * @param nbNodes  the number of modified nodes
+ * @returns 0 if the modified parts of the document are schemas
+ * valid, a positive error code number otherwise and -1 in case of
+ * internal or API error.
+ */
+int
+xmlSchemaRevalidateDoc(xmlSchemaValidCtxt *ctxt, xmlDoc *doc,
+                       xmlNode **nodes, int nbNodes)
+{
+    xmlSchemaIncRun run;
+    xmlNodePtr root, node;
+    int i, depth, ret;
+
+    if ((ctxt == NULL) || (doc == NULL) || (nbNodes < 0) ||
+        ((nodes == NULL) && (nbNodes > 0)))
+        return (-1);
+
+    root = xmlDocGetRootElement(doc);
+    if ((root == NULL) || (ctxt->schema == NULL))
+        return (xmlSchemaValidateDoc(ctxt, doc));
+
+    memset(&run, 0, sizeof(run));
+    run.fullDepth = -1;
+    if (nbNodes > 0) {
+        run.nodes = xmlMalloc(nbNodes * sizeof(run.nodes[0]));
+        if (run.nodes == NULL) {
+            xmlSchemaVErrMemory(ctxt);
+            return (-1);
+        }
+    }
+
+    depth = 0;
+    for (i = 0; i < nbNodes; i++) {
+        node = nodes[i];
+        while ((node != NULL) && (node->type != XML_ELEMENT_NODE)) {
+            if (node->type == XML_DOCUMENT_NODE) {
+                xmlFree(run.nodes);
+                return (xmlSchemaValidateDoc(ctxt, doc));
+            }
+            node = node->parent;
+        }
+        if ((node == NULL) || (node->doc != doc))
+            continue;
+        run.nodes[run.nbNodes++] = node;
+        for (node = node->parent; node != NULL; node = node->parent)
+            depth++;
+    }
+    if (run.nbNodes == 0) {
+        xmlFree(run.nodes);
+        return (0);
+    }
+
+    run.path = xmlMalloc(depth * sizeof(run.path[0]));
+    if ((run.path == NULL) && (depth > 0)) {
+        xmlFree(run.nodes);
+        xmlSchemaVErrMemory(ctxt);
+        return (-1);
+    }
+    for (i = 0; i < run.nbNodes; i++) {
+        for (node = run.nodes[i]->parent; node != NULL; node = node->parent)
+            run.path[run.nbPath++] = node;
+    }
+    qsort(run.nodes, run.nbNodes, sizeof(run.nodes[0]), xmlSchemaIncCompare);
+    if (run.nbPath > 0)
+        qsort(run.path, run.nbPath, sizeof(run.path[0]),
+              xmlSchemaIncCompare);
+
+    ctxt->doc = doc;
+    ctxt->node = root;
+    ctxt->validationRoot = root;
+    ctxt->incRun = &run;
+    ret = xmlSchemaVStart(ctxt);
+    ctxt->incRun = NULL;
+
+    xmlFree(run.nodes);
+    xmlFree(run.path);
+    return (ret);
+}
+
 
 /************************************************************************
  *									*
@@ -28262,6 +32645,63 @@ xmlSchemaSAXUnplug(xmlSchemaSAXPlugStruct *plug)
     return(0);
 }
 
+/**
+ * Attach a validation context to a parser. Unlike with
+ * #xmlSchemaSAXPlug, the SAX handler and user data of the parser are
+ * left alone. The parser passes its element and text events to the
+ * validation context directly, after the SAX callbacks.
+ *
+ * @param vctxt  a schema validation context
+ * @param pctxt  a parser context with a SAX2 handler
+ * @returns 0 on success or -1 if the parser doesn't report SAX2
+ * events or already has a validation context attached.
+ */
+int
+xmlSchemaValidateAttach(xmlSchemaValidCtxt *vctxt, xmlParserCtxt *pctxt)
+{
+    xmlSAXHandlerPtr sax;
+
+    if ((vctxt == NULL) || (pctxt == NULL) || (pctxt->sax == NULL) ||
+        (pctxt->schemaValid != NULL) || (vctxt->hookCtxt != NULL) ||
+        (pctxt->options & XML_PARSE_SAX1))
+        return(-1);
+
+    /*
+     * Same restrictions as xmlSchemaSAXPlug
+     */
+    sax = pctxt->sax;
+    if (sax->initialized != XML_SAX2_MAGIC)
+        return(-1);
+    if ((sax->startElementNs == NULL) && (sax->endElementNs == NULL) &&
+        ((sax->startElement != NULL) || (sax->endElement != NULL)))
+        return(-1);
+
+    pctxt->schemaValid = vctxt;
+    vctxt->hookCtxt = pctxt;
+    vctxt->sax = sax;
+    vctxt->flags |= XML_SCHEMA_VALID_CTXT_FLAG_STREAM;
+    xmlSchemaPreRun(vctxt);
+    return(0);
+}
+
+/**
+ * Detach a validation context from the parser it was attached to
+ * with #xmlSchemaValidateAttach.
+ *
+ * @param vctxt  a schema validation context
+ */
+void
+xmlSchemaValidateDetach(xmlSchemaValidCtxt *vctxt)
+{
+    if ((vctxt == NULL) || (vctxt->hookCtxt == NULL))
+        return;
+
+    xmlSchemaPostRun(vctxt);
+    vctxt->hookCtxt->schemaValid = NULL;
+    vctxt->hookCtxt = NULL;
+    vctxt->sax = NULL;
+}
+
 /**
  * Allows to set a locator function to the validation context,
  * which will be used to provide file and line information since
@@ -28325,7 +32765,7 @@ xmlSchemaValidateStreamLocator(void *ctx, const char **file,
 static int
 xmlSchemaValidateStreamInternal(xmlSchemaValidCtxtPtr ctxt,
                                  xmlParserCtxtPtr pctxt) {
-    xmlSchemaSAXPlugPtr plug = NULL;
+    xmlSAXHandler emptySax;
     int ret;
 
     xmlSchemaValidateSetLocator(ctxt, xmlSchemaValidateStreamLocator, pctxt);
@@ -28334,16 +32774,21 @@ xmlSchemaValidateStreamInternal(xmlSchemaValidCtxtPtr ctxt,
     ctxt->input = pctxt->input->buf;
 
     /*
-     * Plug the validation and launch the parsing
+     * Without a SAX handler, events only go to the validation context.
      */
-    plug = xmlSchemaSAXPlug(ctxt, &(pctxt->sax), &(pctxt->userData));
-    if (plug == NULL) {
+    if (pctxt->sax == NULL) {
+        memset(&emptySax, 0, sizeof(emptySax));
+        emptySax.initialized = XML_SAX2_MAGIC;
+        pctxt->sax = &emptySax;
+    }
+
+    /*
+     * Attach the validation and launch the parsing
+     */
+    if (xmlSchemaValidateAttach(ctxt, pctxt) < 0) {
         ret = -1;
 	goto done;
     }
-    ctxt->input = pctxt->input->buf;
-    ctxt->sax = pctxt->sax;
-    ctxt->flags |= XML_SCHEMA_VALID_CTXT_FLAG_STREAM;
     ret = xmlSchemaVStart(ctxt);
 
     if ((ret == 0) && (! ctxt->parserCtxt->wellFormed)) {
@@ -28353,12 +32798,12 @@ xmlSchemaValidateStreamInternal(xmlSchemaValidCtxtPtr ctxt,
     }
 
 done:
+    xmlSchemaValidateDetach(ctxt);
+    if (pctxt->sax == &emptySax)
+        pctxt->sax = NULL;
     ctxt->parserCtxt = NULL;
     ctxt->sax = NULL;
     ctxt->input = NULL;
-    if (plug != NULL) {
-        xmlSchemaSAXUnplug(plug);
-    }
     return (ret);
 }
 
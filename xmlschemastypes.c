@@ -35,6 +35,7 @@
 #include <libxml/xmlschemastypes.h>
 
 #include "private/error.h"
+#include "private/schemas.h"
 #include "private/threads.h"
 
 #ifndef isnan
@@ -120,6 +121,7 @@ struct _xmlSchemaVal {
 	int			b;
 	xmlChar                *str;
     } value;
+    xmlChar *canon; /* cached canonical representation */
 };
 
 static int xmlSchemaTypesInitialized = 0;
@@ -1307,6 +1309,8 @@ xmlSchemaFreeValue(xmlSchemaVal *value) {
 	    default:
 		break;
 	}
+        if (value->canon != NULL)
+            xmlFree(value->canon);
 	prev = value;
 	value = value->next;
 	xmlFree(prev);
@@ -1778,6 +1782,7 @@ static int
 xmlSchemaValidateDates (xmlSchemaValType type,
 	                const xmlChar *dateTime, xmlSchemaValPtr *val,
 			int collapse) {
+    xmlSchemaVal tmp;
     xmlSchemaValPtr dt;
     int ret;
     const xmlChar *cur = dateTime;
@@ -1802,9 +1807,18 @@ xmlSchemaValidateDates (xmlSchemaValType type,
     if ((*cur != '-') && (*cur < '0') && (*cur > '9'))
 	return 1;
 
-    dt = xmlSchemaNewValue(XML_SCHEMAS_UNKNOWN);
-    if (dt == NULL)
-	return -1;
+    /*
+     * Parse into a value on the stack if the caller only wants
+     * to know whether the string is valid.
+     */
+    if (val == NULL) {
+        memset(&tmp, 0, sizeof(tmp));
+        dt = &tmp;
+    } else {
+        dt = xmlSchemaNewValue(XML_SCHEMAS_UNKNOWN);
+        if (dt == NULL)
+            return -1;
+    }
 
     if ((cur[0] == '-') && (cur[1] == '-')) {
 	/*
@@ -1879,8 +1893,11 @@ xmlSchemaValidateDates (xmlSchemaValType type,
     /*
      * It's a right-truncated date or an xs:time.
      * Try to parse an xs:time then fallback on right-truncated dates.
+     * Skip the xs:time attempt if another type is expected, it
+     * always fails for the common xs:date and xs:dateTime layouts.
      */
-    if ((*cur >= '0') && (*cur <= '9')) {
+    if (((type == XML_SCHEMAS_UNKNOWN) || (type == XML_SCHEMAS_TIME)) &&
+        (*cur >= '0') && (*cur <= '9')) {
 	ret = _xmlSchemaParseTime(&(dt->value.date), &cur);
 	if (ret == 0) {
 	    /* it's an xs:time */
@@ -1974,13 +1991,11 @@ done:
 
     if (val != NULL)
         *val = dt;
-    else
-	xmlSchemaFreeValue(dt);
 
     return 0;
 
 error:
-    if (dt != NULL)
+    if (dt != &tmp)
 	xmlSchemaFreeValue(dt);
     return 1;
 }
@@ -2001,6 +2016,7 @@ xmlSchemaValidateDuration (xmlSchemaTypePtr type ATTRIBUTE_UNUSED,
 	                   const xmlChar *duration, xmlSchemaValPtr *val,
 			   int collapse) {
     const xmlChar  *cur = duration;
+    xmlSchemaVal tmp;
     xmlSchemaValPtr dur;
     int isneg = 0;
     unsigned int seq = 0;
@@ -2025,9 +2041,14 @@ xmlSchemaValidateDuration (xmlSchemaTypePtr type ATTRIBUTE_UNUSED,
     if (*cur == 0)
 	return 1;
 
-    dur = xmlSchemaNewValue(XML_SCHEMAS_DURATION);
-    if (dur == NULL)
-	return -1;
+    if (val == NULL) {
+        memset(&tmp, 0, sizeof(tmp));
+        dur = &tmp;
+    } else {
+        dur = xmlSchemaNewValue(XML_SCHEMAS_DURATION);
+        if (dur == NULL)
+            return -1;
+    }
 
     while (*cur != 0) {
         long           num = 0;
@@ -2147,13 +2168,11 @@ xmlSchemaValidateDuration (xmlSchemaTypePtr type ATTRIBUTE_UNUSED,
 
     if (val != NULL)
         *val = dur;
-    else
-	xmlSchemaFreeValue(dur);
 
     return 0;
 
 error:
-    if (dur != NULL)
+    if (dur != &tmp)
 	xmlSchemaFreeValue(dur);
     return 1;
 }
@@ -2377,6 +2396,96 @@ static int xmlSchemaParseUInt(const xmlChar **str, xmlSchemaValDecimalPtr val) {
     return(ret);
 }
 
+/**
+ * Check an integer of one of the derived integer types without
+ * computing its value. Only integers with at most 19 significant
+ * digits are handled, which fit in an unsigned long long.
+ *
+ * @param type  the built-in integer type
+ * @param value  the value to check
+ * @param collapse  whether to skip surrounding blanks
+ * @returns 0 if the value is valid, 1 if it's invalid or 2 if it's
+ *         too long for this check.
+ */
+static int
+xmlSchemaCheckSmallInteger(xmlSchemaValType type, const xmlChar *value,
+                           int collapse) {
+    const xmlChar *cur = value;
+    unsigned long long mag = 0, max;
+    int neg = 0, digits = 0;
+
+    if (collapse)
+        while IS_WSP_BLANK_CH(*cur) cur++;
+    if (*cur == '-') {
+        neg = 1;
+        cur++;
+    } else if (*cur == '+') {
+        cur++;
+    }
+    if ((*cur < '0') || (*cur > '9'))
+        return(1);
+    while (*cur == '0')
+        cur++;
+    while ((*cur >= '0') && (*cur <= '9')) {
+        if (++digits > 19)
+            return(2);
+        mag = mag * 10 + (*cur - '0');
+        cur++;
+    }
+    if (collapse)
+        while IS_WSP_BLANK_CH(*cur) cur++;
+    if (*cur != 0)
+        return(1);
+
+    /* "-0" is zero and not negative, except for positiveInteger. */
+    if (mag == 0)
+        neg = (type == XML_SCHEMAS_PINTEGER) ? neg : 0;
+
+    switch (type) {
+        case XML_SCHEMAS_INTEGER:
+            return(0);
+        case XML_SCHEMAS_PINTEGER:
+            return((neg) || (mag == 0));
+        case XML_SCHEMAS_NPINTEGER:
+            return((!neg) && (mag != 0));
+        case XML_SCHEMAS_NINTEGER:
+            return(!neg);
+        case XML_SCHEMAS_NNINTEGER:
+        case XML_SCHEMAS_ULONG:
+            return(neg);
+        case XML_SCHEMAS_LONG:
+            max = 0x7FFFFFFFFFFFFFFFull;
+            break;
+        case XML_SCHEMAS_INT:
+            max = 0x7FFFFFFF;
+            break;
+        case XML_SCHEMAS_SHORT:
+            max = 0x7FFF;
+            break;
+        case XML_SCHEMAS_BYTE:
+            max = 0x7F;
+            break;
+        case XML_SCHEMAS_UINT:
+            max = 0xFFFFFFFF;
+            break;
+        case XML_SCHEMAS_USHORT:
+            max = 0xFFFF;
+            break;
+        case XML_SCHEMAS_UBYTE:
+            max = 0xFF;
+            break;
+        default:
+            return(2);
+    }
+    if ((type == XML_SCHEMAS_UINT) || (type == XML_SCHEMAS_USHORT) ||
+        (type == XML_SCHEMAS_UBYTE))
+        return((neg) || (mag > max));
+    /* The minimum of the signed types is -(max + 1). */
+    if (neg)
+        return(mag - 1 > max);
+    return(mag > max);
+}
+
 /*
  * Check that a value conforms to the lexical space of the language datatype.
  * Must conform to [a-zA-Z]{1,8}(-[a-zA-Z0-9]{1,8})*
@@ -2440,8 +2549,10 @@ xmlSchemaValAtomicType(xmlSchemaTypePtr type, const xmlChar * value,
     xmlChar *norm = NULL;
     int ret = 0;
 
-    if (xmlSchemaInitTypes() < 0)
-        return (-1);
+    /*
+     * Built-in types are only handed out after xmlSchemaInitTypes,
+     * so there's no need to take the types mutex for every value.
+     */
     if (type == NULL)
         return (-1);
 
@@ -3441,6 +3552,17 @@ xmlSchemaValAtomicType(xmlSchemaTypePtr type, const xmlChar * value,
 
                 if (cur == NULL)
                     goto return1;
+                /*
+                 * Avoid building a decimal if the value isn't needed.
+                 */
+                if (val == NULL) {
+                    ret = xmlSchemaCheckSmallInteger(type->builtInType,
+                                                     cur, normOnTheFly);
+                    if (ret == 0)
+                        goto return0;
+                    if (ret == 1)
+                        goto return1;
+                }
  		if (normOnTheFly)
 		    while IS_WSP_BLANK_CH(*cur) cur++;
                 if (*cur == '-') {
@@ -3788,6 +3910,7 @@ xmlSchemaDupVal (xmlSchemaValPtr v)
 
     memcpy(ret, v, sizeof(xmlSchemaVal));
     ret->next = NULL;
+    ret->canon = NULL;
     return ret;
 }
 
@@ -3897,6 +4020,234 @@ error:
     return (NULL);
 }
 
+/**
+ * Writes a precomputed value, including the following items of a
+ * list, in binary form.
+ *
+ * @param val  the precomputed value
+ * @param buf  the output buffer
+ */
+void
+xmlSchemaValSave(xmlSchemaVal *val, xmlBuf *buf)
+{
+    xmlSchemaValPtr cur;
+    int n = 0;
+
+    for (cur = val; cur != NULL; cur = cur->next)
+        n++;
+    xmlBinWriteInt(buf, n);
+
+    for (cur = val; cur != NULL; cur = cur->next) {
+        xmlBinWriteInt(buf, cur->type);
+	switch (cur->type) {
+	    case XML_SCHEMAS_STRING:
+	    case XML_SCHEMAS_NORMSTRING:
+	    case XML_SCHEMAS_TOKEN:
+	    case XML_SCHEMAS_LANGUAGE:
+	    case XML_SCHEMAS_NMTOKEN:
+	    case XML_SCHEMAS_NMTOKENS:
+	    case XML_SCHEMAS_NAME:
+	    case XML_SCHEMAS_NCNAME:
+	    case XML_SCHEMAS_ID:
+	    case XML_SCHEMAS_IDREF:
+	    case XML_SCHEMAS_IDREFS:
+	    case XML_SCHEMAS_ENTITY:
+	    case XML_SCHEMAS_ENTITIES:
+	    case XML_SCHEMAS_ANYURI:
+	    case XML_SCHEMAS_ANYSIMPLETYPE:
+                xmlBinWriteString(buf, cur->value.str);
+		break;
+	    case XML_SCHEMAS_NOTATION:
+	    case XML_SCHEMAS_QNAME:
+                xmlBinWriteString(buf, cur->value.qname.name);
+                xmlBinWriteString(buf, cur->value.qname.uri);
+		break;
+	    case XML_SCHEMAS_HEXBINARY:
+                xmlBinWriteString(buf, cur->value.hex.str);
+                xmlBinWriteInt(buf, cur->value.hex.total);
+		break;
+	    case XML_SCHEMAS_BASE64BINARY:
+                xmlBinWriteString(buf, cur->value.base64.str);
+                xmlBinWriteInt(buf, cur->value.base64.total);
+		break;
+	    case XML_SCHEMAS_DECIMAL:
+	    case XML_SCHEMAS_INTEGER:
+	    case XML_SCHEMAS_NNINTEGER:
+	    case XML_SCHEMAS_PINTEGER:
+	    case XML_SCHEMAS_NPINTEGER:
+	    case XML_SCHEMAS_NINTEGER:
+	    case XML_SCHEMAS_INT:
+	    case XML_SCHEMAS_UINT:
+	    case XML_SCHEMAS_LONG:
+	    case XML_SCHEMAS_ULONG:
+	    case XML_SCHEMAS_SHORT:
+	    case XML_SCHEMAS_USHORT:
+	    case XML_SCHEMAS_BYTE:
+	    case XML_SCHEMAS_UBYTE:
+                xmlBinWriteString(buf, cur->value.decimal.str);
+                xmlBinWriteInt(buf, cur->value.decimal.integralPlaces);
+                xmlBinWriteInt(buf, cur->value.decimal.fractionalPlaces);
+		break;
+	    case XML_SCHEMAS_TIME:
+	    case XML_SCHEMAS_GDAY:
+	    case XML_SCHEMAS_GMONTH:
+	    case XML_SCHEMAS_GMONTHDAY:
+	    case XML_SCHEMAS_GYEAR:
+	    case XML_SCHEMAS_GYEARMONTH:
+	    case XML_SCHEMAS_DATE:
+	    case XML_SCHEMAS_DATETIME:
+                xmlBinWriteLong(buf, cur->value.date.year);
+                xmlBinWriteInt(buf, cur->value.date.mon);
+                xmlBinWriteInt(buf, cur->value.date.day);
+                xmlBinWriteInt(buf, cur->value.date.hour);
+                xmlBinWriteInt(buf, cur->value.date.min);
+                xmlBinWriteDouble(buf, cur->value.date.sec);
+                xmlBinWriteInt(buf, cur->value.date.tz_flag);
+                xmlBinWriteInt(buf, cur->value.date.tzo);
+		break;
+	    case XML_SCHEMAS_DURATION:
+                xmlBinWriteLong(buf, cur->value.dur.mon);
+                xmlBinWriteLong(buf, cur->value.dur.day);
+                xmlBinWriteDouble(buf, cur->value.dur.sec);
+		break;
+	    case XML_SCHEMAS_FLOAT:
+                xmlBinWriteDouble(buf, cur->value.f);
+		break;
+	    case XML_SCHEMAS_DOUBLE:
+                xmlBinWriteDouble(buf, cur->value.d);
+		break;
+	    case XML_SCHEMAS_BOOLEAN:
+                xmlBinWriteInt(buf, cur->value.b);
+		break;
+	    default:
+		break;
+	}
+    }
+}
+
+/**
+ * Reads a precomputed value written by xmlSchemaValSave.
+ *
+ * @param reader  the input
+ * @returns the value, NULL if none was saved or in case of error.
+ * Errors are reported by the reader.
+ */
+xmlSchemaVal *
+xmlSchemaValLoad(xmlBinReader *reader)
+{
+    xmlSchemaValPtr ret = NULL, prev = NULL, cur;
+    int i, n;
+
+    n = xmlBinReadInt(reader);
+    if ((n < 0) || ((reader->end - reader->cur) / 4 < n)) {
+        reader->error = 1;
+        return(NULL);
+    }
+
+    for (i = 0; i < n; i++) {
+        cur = xmlSchemaNewValue(xmlBinReadInt(reader));
+        if (cur == NULL) {
+            reader->error = 1;
+            break;
+        }
+	if (ret == NULL)
+	    ret = cur;
+	else
+	    prev->next = cur;
+	prev = cur;
+
+	switch (cur->type) {
+	    case XML_SCHEMAS_STRING:
+	    case XML_SCHEMAS_NORMSTRING:
+	    case XML_SCHEMAS_TOKEN:
+	    case XML_SCHEMAS_LANGUAGE:
+	    case XML_SCHEMAS_NMTOKEN:
+	    case XML_SCHEMAS_NMTOKENS:
+	    case XML_SCHEMAS_NAME:
+	    case XML_SCHEMAS_NCNAME:
+	    case XML_SCHEMAS_ID:
+	    case XML_SCHEMAS_IDREF:
+	    case XML_SCHEMAS_IDREFS:
+	    case XML_SCHEMAS_ENTITY:
+	    case XML_SCHEMAS_ENTITIES:
+	    case XML_SCHEMAS_ANYURI:
+	    case XML_SCHEMAS_ANYSIMPLETYPE:
+                cur->value.str = xmlBinReadStrdup(reader);
+		break;
+	    case XML_SCHEMAS_NOTATION:
+	    case XML_SCHEMAS_QNAME:
+                cur->value.qname.name = xmlBinReadStrdup(reader);
+                cur->value.qname.uri = xmlBinReadStrdup(reader);
+		break;
+	    case XML_SCHEMAS_HEXBINARY:
+                cur->value.hex.str = xmlBinReadStrdup(reader);
+                cur->value.hex.total = xmlBinReadInt(reader);
+		break;
+	    case XML_SCHEMAS_BASE64BINARY:
+                cur->value.base64.str = xmlBinReadStrdup(reader);
+                cur->value.base64.total = xmlBinReadInt(reader);
+		break;
+	    case XML_SCHEMAS_DECIMAL:
+	    case XML_SCHEMAS_INTEGER:
+	    case XML_SCHEMAS_NNINTEGER:
+	    case XML_SCHEMAS_PINTEGER:
+	    case XML_SCHEMAS_NPINTEGER:
+	    case XML_SCHEMAS_NINTEGER:
+	    case XML_SCHEMAS_INT:
+	    case XML_SCHEMAS_UINT:
+	    case XML_SCHEMAS_LONG:
+	    case XML_SCHEMAS_ULONG:
+	    case XML_SCHEMAS_SHORT:
+	    case XML_SCHEMAS_USHORT:
+	    case XML_SCHEMAS_BYTE:
+	    case XML_SCHEMAS_UBYTE:
+                cur->value.decimal.str = xmlBinReadStrdup(reader);
+                cur->value.decimal.integralPlaces = xmlBinReadInt(reader);
+                cur->value.decimal.fractionalPlaces = xmlBinReadInt(reader);
+		break;
+	    case XML_SCHEMAS_TIME:
+	    case XML_SCHEMAS_GDAY:
+	    case XML_SCHEMAS_GMONTH:
+	    case XML_SCHEMAS_GMONTHDAY:
+	    case XML_SCHEMAS_GYEAR:
+	    case XML_SCHEMAS_GYEARMONTH:
+	    case XML_SCHEMAS_DATE:
+	    case XML_SCHEMAS_DATETIME:
+                cur->value.date.year = xmlBinReadLong(reader);
+                cur->value.date.mon = xmlBinReadInt(reader);
+                cur->value.date.day = xmlBinReadInt(reader);
+                cur->value.date.hour = xmlBinReadInt(reader);
+                cur->value.date.min = xmlBinReadInt(reader);
+                cur->value.date.sec = xmlBinReadDouble(reader);
+                cur->value.date.tz_flag = xmlBinReadInt(reader);
+                cur->value.date.tzo = xmlBinReadInt(reader);
+		break;
+	    case XML_SCHEMAS_DURATION:
+                cur->value.dur.mon = xmlBinReadLong(reader);
+                cur->value.dur.day = xmlBinReadLong(reader);
+                cur->value.dur.sec = xmlBinReadDouble(reader);
+		break;
+	    case XML_SCHEMAS_FLOAT:
+                cur->value.f = (float) xmlBinReadDouble(reader);
+		break;
+	    case XML_SCHEMAS_DOUBLE:
+                cur->value.d = xmlBinReadDouble(reader);
+		break;
+	    case XML_SCHEMAS_BOOLEAN:
+                cur->value.b = xmlBinReadInt(reader);
+		break;
+	    default:
+		break;
+	}
+    }
+
+    if (reader->error) {
+        xmlSchemaFreeValue(ret);
+        return(NULL);
+    }
+    return(ret);
+}
+
 /**
  * Compute a new date/time from `dt` and `dur`. This function assumes `dt`
  * is either \#XML_SCHEMAS_DATETIME, \#XML_SCHEMAS_DATE, \#XML_SCHEMAS_GYEARMONTH,
@@ -5724,66 +6075,17 @@ xmlSchemaValidateFacetWhtsp(xmlSchemaFacet *facet,
 	 value, val, ws));
 }
 
-/**
- * Get the canonical lexical representation of the value.
- * The caller has to FREE the returned retValue.
- *
- * WARNING: Some value types are not supported yet, resulting
- * in a `retValue` of "???".
- *
- * TODO: XML Schema 1.0 does not define canonical representations
- * for: duration, gYearMonth, gYear, gMonthDay, gMonth, gDay,
- * anyURI, QName, NOTATION. This will be fixed in XML Schema 1.1.
- *
- *
- * @param val  the precomputed value
- * @param retValue  the returned value
- * @returns 0 if the value could be built, 1 if the value type is
- * not supported yet and -1 in case of API errors.
+/*
+ * Format the canonical representation of non-string values. The
+ * caller has to free the returned retValue. Returns 0 if the value
+ * could be built, 1 if the value type is not supported yet and -1 if
+ * a memory allocation failed.
  */
-int
-xmlSchemaGetCanonValue(xmlSchemaVal *val, const xmlChar **retValue)
+static int
+xmlSchemaFormatCanonValue(xmlSchemaValPtr val, const xmlChar **retValue)
 {
-    if ((retValue == NULL) || (val == NULL))
-	return (-1);
     *retValue = NULL;
     switch (val->type) {
-	case XML_SCHEMAS_STRING:
-	    if (val->value.str == NULL)
-		*retValue = BAD_CAST xmlStrdup(BAD_CAST "");
-	    else
-		*retValue =
-		    BAD_CAST xmlStrdup((const xmlChar *) val->value.str);
-	    break;
-	case XML_SCHEMAS_NORMSTRING:
-	    if (val->value.str == NULL)
-		*retValue = BAD_CAST xmlStrdup(BAD_CAST "");
-	    else {
-		*retValue = xmlSchemaWhiteSpaceReplace(
-		    (const xmlChar *) val->value.str);
-		if ((*retValue) == NULL)
-		    *retValue = BAD_CAST xmlStrdup(
-			(const xmlChar *) val->value.str);
-	    }
-	    break;
-	case XML_SCHEMAS_TOKEN:
-	case XML_SCHEMAS_LANGUAGE:
-	case XML_SCHEMAS_NMTOKEN:
-	case XML_SCHEMAS_NAME:
-	case XML_SCHEMAS_NCNAME:
-	case XML_SCHEMAS_ID:
-	case XML_SCHEMAS_IDREF:
-	case XML_SCHEMAS_ENTITY:
-	case XML_SCHEMAS_NOTATION: /* Unclear */
-	case XML_SCHEMAS_ANYURI:   /* Unclear */
-	    if (val->value.str == NULL)
-		return (-1);
-	    *retValue =
-		BAD_CAST xmlSchemaCollapseString(BAD_CAST val->value.str);
-	    if (*retValue == NULL)
-		*retValue =
-		    BAD_CAST xmlStrdup((const xmlChar *) val->value.str);
-	    break;
 	case XML_SCHEMAS_QNAME:
 	    /* TODO: Unclear in XML Schema 1.0. */
 	    if (val->value.qname.uri == NULL) {
@@ -6053,7 +6355,6 @@ xmlSchemaGetCanonValue(xmlSchemaVal *val, const xmlChar **retValue)
 	    }
 	    break;
 	default:
-	    *retValue = BAD_CAST xmlStrdup(BAD_CAST "???");
 	    return (1);
     }
     if (*retValue == NULL)
@@ -6061,6 +6362,145 @@ xmlSchemaGetCanonValue(xmlSchemaVal *val, const xmlChar **retValue)
     return (0);
 }
 
+/**
+ * Get the canonical representation of a value, computing it on
+ * first use. Strings which are already canonical are returned as is,
+ * other representations are cached in the value.
+ *
+ * @param val  the precomputed value
+ * @param canon  the canonical representation, owned by the value
+ * @returns 0 if the representation could be built, 1 if the value
+ * type is not supported yet and -1 if a memory allocation failed.
+ */
+int
+xmlSchemaValCanon(xmlSchemaVal *val, const xmlChar **canon)
+{
+    const xmlChar *str = val->value.str;
+    xmlChar *tmp;
+    int res;
+
+    if (val->canon != NULL) {
+        *canon = val->canon;
+        return(0);
+    }
+
+    switch (val->type) {
+	case XML_SCHEMAS_STRING:
+            *canon = (str != NULL) ? str : BAD_CAST "";
+            return(0);
+	case XML_SCHEMAS_NORMSTRING:
+            if (str == NULL) {
+                *canon = BAD_CAST "";
+                return(0);
+            }
+            tmp = xmlSchemaWhiteSpaceReplace(str);
+            break;
+	case XML_SCHEMAS_TOKEN:
+	case XML_SCHEMAS_LANGUAGE:
+	case XML_SCHEMAS_NMTOKEN:
+	case XML_SCHEMAS_NAME:
+	case XML_SCHEMAS_NCNAME:
+	case XML_SCHEMAS_ID:
+	case XML_SCHEMAS_IDREF:
+	case XML_SCHEMAS_ENTITY:
+	case XML_SCHEMAS_NOTATION: /* Unclear */
+	case XML_SCHEMAS_ANYURI:   /* Unclear */
+            *canon = NULL;
+            if (str == NULL)
+                return(-1);
+            tmp = xmlSchemaCollapseString(str);
+            break;
+        default:
+            res = xmlSchemaFormatCanonValue(val, canon);
+            if (res != 0) {
+                xmlFree((xmlChar *) *canon);
+                *canon = NULL;
+                return(res);
+            }
+            val->canon = (xmlChar *) *canon;
+            return(0);
+    }
+
+    /* NULL means that the string needs no normalization */
+    if (tmp == NULL) {
+        *canon = str;
+    } else {
+        val->canon = tmp;
+        *canon = tmp;
+    }
+    return(0);
+}
+
+/**
+ * Get the canonical lexical representation of the value. The
+ * representation is computed on first use and cached in the value.
+ *
+ * Since the cache is filled lazily, a value must not be passed to
+ * this function from multiple threads at the same time. Values of
+ * compiled schemas are prepared when the schema is built.
+ *
+ * @since 2.16.0
+ *
+ * @param val  the precomputed value
+ * @returns the canonical representation owned by the value, or NULL
+ * if the value type isn't supported or a memory allocation failed.
+ */
+const xmlChar *
+xmlSchemaValueGetCanon(xmlSchemaVal *val)
+{
+    const xmlChar *canon;
+
+    if (val == NULL)
+        return(NULL);
+    if (xmlSchemaValCanon(val, &canon) != 0)
+        return(NULL);
+    return(canon);
+}
+
+/**
+ * Get the canonical lexical representation of the value.
+ * The caller has to FREE the returned retValue.
+ *
+ * WARNING: Some value types are not supported yet, resulting
+ * in a `retValue` of "???".
+ *
+ * TODO: XML Schema 1.0 does not define canonical representations
+ * for: duration, gYearMonth, gYear, gMonthDay, gMonth, gDay,
+ * anyURI, QName, NOTATION. This will be fixed in XML Schema 1.1.
+ *
+ * The representation is cached in the value, see
+ * #xmlSchemaValueGetCanon.
+ *
+ * @param val  the precomputed value
+ * @param retValue  the returned value
+ * @returns 0 if the value could be built, 1 if the value type is
+ * not supported yet and -1 in case of API errors.
+ */
+int
+xmlSchemaGetCanonValue(xmlSchemaVal *val, const xmlChar **retValue)
+{
+    const xmlChar *canon;
+    int res;
+
+    if ((retValue == NULL) || (val == NULL))
+	return (-1);
+    *retValue = NULL;
+    res = xmlSchemaValCanon(val, &canon);
+    if (res == 1) {
+        *retValue = BAD_CAST xmlStrdup(BAD_CAST "???");
+        return((*retValue == NULL) ? -1 : 1);
+    }
+    if (res != 0)
+        return(-1);
+    /* A QName without a name */
+    if (canon == NULL)
+        return(0);
+    *retValue = xmlStrdup(canon);
+    if (*retValue == NULL)
+	return(-1);
+    return (0);
+}
+
 /**
  * Get the canonical representation of the value.
  * The caller has to free the returned `retValue`.
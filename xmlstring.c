@@ -23,6 +23,7 @@
 #include <libxml/xmlstring.h>
 
 #include "private/parser.h"
+#include "private/simd.h"
 #include "private/string.h"
 
 #ifndef va_copy
@@ -158,14 +159,7 @@ xmlStrEqual(const xmlChar *str1, const xmlChar *str2) {
     if (str1 == str2) return(1);
     if (str1 == NULL) return(0);
     if (str2 == NULL) return(0);
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
     return(strcmp((const char *)str1, (const char *)str2) == 0);
-#else
-    do {
-        if (*str1++ != *str2) return(0);
-    } while (*str2++);
-    return(1);
-#endif
 }
 
 /**
@@ -208,15 +202,7 @@ xmlStrncmp(const xmlChar *str1, const xmlChar *str2, int len) {
     if (str1 == str2) return(0);
     if (str1 == NULL) return(-1);
     if (str2 == NULL) return(1);
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
     return(strncmp((const char *)str1, (const char *)str2, len));
-#else
-    do {
-        int tmp = *str1++ - *str2;
-        if (tmp != 0 || --len == 0) return(tmp);
-    } while (*str2++ != 0);
-    return 0;
-#endif
 }
 
 static const xmlChar casemap[256] = {
@@ -328,20 +314,9 @@ xmlStrchr(const xmlChar *str, xmlChar val) {
 
 const xmlChar *
 xmlStrstr(const xmlChar *str, const xmlChar *val) {
-    int n;
-
     if (str == NULL) return(NULL);
     if (val == NULL) return(NULL);
-    n = xmlStrlen(val);
-
-    if (n == 0) return(str);
-    while (*str != 0) { /* non input consuming */
-        if (*str == *val) {
-            if (!xmlStrncmp(str, val, n)) return((const xmlChar *) str);
-        }
-        str++;
-    }
-    return(NULL);
+    return((const xmlChar *) strstr((const char *) str, (const char *) val));
 }
 
 /**
@@ -752,6 +727,29 @@ xmlUTF8Charcmp(const xmlChar *utf1, const xmlChar *utf2) {
     return xmlStrncmp(utf1, utf2, xmlUTF8Size(utf1));
 }
 
+/*
+ * Skip up to `len` well-formed characters with the vector kernels.
+ * Callers finish the job with their own loops. Short prefixes aren't
+ * worth the setup.
+ */
+static const xmlChar *
+xmlUTF8SkipChars(const xmlChar *utf, int len, size_t *nchars) {
+    const xmlChar *end;
+    size_t max;
+
+    *nchars = 0;
+    if (len < 16)
+        return(utf);
+
+    /* A character takes at most four bytes */
+    max = (size_t) len <= SIZE_MAX / 4 ? (size_t) len * 4 : SIZE_MAX;
+    end = memchr(utf, 0, max);
+    if (end == NULL)
+        end = utf + max;
+
+    return(xmlScanUtf8Chars(utf, end, len, nchars));
+}
+
 /**
  * compute the length of an UTF8 string, it doesn't do a full UTF8
  * checking of the content of the string.
@@ -766,6 +764,8 @@ xmlUTF8Strlen(const xmlChar *utf) {
     if (utf == NULL)
         return(-1);
 
+    utf = xmlScanUtf8Chars(utf, utf + strlen((const char *) utf), SIZE_MAX,
+                           &ret);
     while (*utf != 0) {
         if (utf[0] & 0x80) {
             if ((utf[1] & 0xc0) != 0x80)
@@ -927,6 +927,7 @@ xmlUTF8Strsize(const xmlChar *utf, int len) {
     const xmlChar *ptr=utf;
     int ch;
     size_t ret;
+    size_t skipped;
 
     if (utf == NULL)
         return(0);
@@ -934,6 +935,8 @@ xmlUTF8Strsize(const xmlChar *utf, int len) {
     if (len <= 0)
         return(0);
 
+    ptr = xmlUTF8SkipChars(utf, len, &skipped);
+    len -= skipped;
     while ( len-- > 0) {
         if ( !*ptr )
             break;
@@ -983,10 +986,13 @@ xmlUTF8Strndup(const xmlChar *utf, int len) {
 const xmlChar *
 xmlUTF8Strpos(const xmlChar *utf, int pos) {
     int ch;
+    size_t skipped;
 
     if (utf == NULL) return(NULL);
     if (pos < 0)
         return(NULL);
+    utf = xmlUTF8SkipChars(utf, pos, &skipped);
+    pos -= skipped;
     while (pos--) {
         ch = *utf++;
         if (ch == 0)
@@ -1053,6 +1059,7 @@ xmlChar *
 xmlUTF8Strsub(const xmlChar *utf, int start, int len) {
     int i;
     int ch;
+    size_t skipped;
 
     if (utf == NULL) return(NULL);
     if (start < 0) return(NULL);
@@ -1061,7 +1068,8 @@ xmlUTF8Strsub(const xmlChar *utf, int start, int len) {
     /*
      * Skip over any leading chars
      */
-    for (i = 0; i < start; i++) {
+    utf = xmlUTF8SkipChars(utf, start, &skipped);
+    for (i = skipped; i < start; i++) {
         ch = *utf++;
         if (ch == 0)
             return(NULL);
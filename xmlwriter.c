@@ -27,6 +27,8 @@
 #include "private/buf.h"
 #include "private/enc.h"
 #include "private/error.h"
+#include "private/io.h"
+#include "private/memory.h"
 #include "private/save.h"
 
 #define B64LINELEN 72
@@ -68,18 +70,21 @@ typedef struct _xmlTextWriterStackEntry xmlTextWriterStackEntry;
 struct _xmlTextWriterStackEntry {
     xmlChar *name;
     xmlTextWriterState state;
+    int owned;                  /* whether name must be freed */
 };
 
 typedef struct _xmlTextWriterNsStackEntry xmlTextWriterNsStackEntry;
 struct _xmlTextWriterNsStackEntry {
     xmlChar *prefix;
     xmlChar *uri;
-    xmlLinkPtr elem;
+    int elem;                   /* depth of the element */
 };
 
 struct _xmlTextWriter {
     xmlOutputBufferPtr out;     /* output buffer */
-    xmlListPtr nodes;           /* element name stack */
+    xmlTextWriterStackEntry *nodeTab; /* element name stack */
+    int nodeNr;
+    int nodeMax;
     xmlListPtr nsstack;         /* name spaces stack */
     int level;
     int indent;                 /* enable indent */
@@ -89,11 +94,36 @@ struct _xmlTextWriter {
     xmlParserCtxtPtr ctxt;
     int no_doc_free;
     xmlDocPtr doc;
+    int trusted;                /* reference element names */
 };
 
-static void xmlFreeTextWriterStackEntry(xmlLinkPtr lk);
-static int xmlCmpTextWriterStackEntry(const void *data0,
-                                      const void *data1);
+/*
+ * Bytes accepted by an output buffer so far, including buffered data.
+ * Used to report the size of text escaped straight into the buffer.
+ */
+static size_t
+xmlTextWriterOutputSize(xmlOutputBufferPtr out) {
+    size_t size = out->written + xmlBufUse(out->buffer);
+
+    if ((out->encoder != NULL) && (out->conv != NULL))
+        size += xmlBufUse(out->conv);
+    return(size);
+}
+
+/*
+ * The innermost open element, PI, comment or DTD construct.
+ */
+static xmlTextWriterStackEntry *
+xmlTextWriterTop(xmlTextWriterPtr writer) {
+    if (writer->nodeNr <= 0)
+        return(NULL);
+    return(&writer->nodeTab[writer->nodeNr - 1]);
+}
+
+static xmlTextWriterStackEntry *
+  xmlTextWriterPushEntry(xmlTextWriterPtr writer, xmlChar *name, int owned,
+                         xmlTextWriterState state);
+static void xmlTextWriterPopEntry(xmlTextWriterPtr writer);
 static int xmlTextWriterOutputNSDecl(xmlTextWriterPtr writer);
 static void xmlFreeTextWriterNsStackEntry(xmlLinkPtr lk);
 static int xmlCmpTextWriterNsStackEntry(const void *data0,
@@ -175,21 +205,11 @@ xmlNewTextWriter(xmlOutputBuffer *out)
     }
     memset(ret, 0, sizeof(xmlTextWriter));
 
-    ret->nodes = xmlListCreate(xmlFreeTextWriterStackEntry,
-                               xmlCmpTextWriterStackEntry);
-    if (ret->nodes == NULL) {
-        xmlWriterErrMsg(NULL, XML_ERR_NO_MEMORY,
-                        "xmlNewTextWriter : out of memory!\n");
-        xmlFree(ret);
-        return NULL;
-    }
-
     ret->nsstack = xmlListCreate(xmlFreeTextWriterNsStackEntry,
                                  xmlCmpTextWriterNsStackEntry);
     if (ret->nsstack == NULL) {
         xmlWriterErrMsg(NULL, XML_ERR_NO_MEMORY,
                         "xmlNewTextWriter : out of memory!\n");
-        xmlListDelete(ret->nodes);
         xmlFree(ret);
         return NULL;
     }
@@ -199,7 +219,6 @@ xmlNewTextWriter(xmlOutputBuffer *out)
     ret->qchar = '"';
 
     if (!ret->ichar) {
-        xmlListDelete(ret->nodes);
         xmlListDelete(ret->nsstack);
         xmlFree(ret);
         xmlWriterErrMsg(NULL, XML_ERR_NO_MEMORY,
@@ -452,8 +471,9 @@ xmlFreeTextWriter(xmlTextWriter *writer)
     if (writer->out != NULL)
         xmlOutputBufferClose(writer->out);
 
-    if (writer->nodes != NULL)
-        xmlListDelete(writer->nodes);
+    while (writer->nodeNr > 0)
+        xmlTextWriterPopEntry(writer);
+    xmlFree(writer->nodeTab);
 
     if (writer->nsstack != NULL)
         xmlListDelete(writer->nsstack);
@@ -489,7 +509,6 @@ xmlTextWriterStartDocument(xmlTextWriter *writer, const char *version,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlCharEncodingHandlerPtr encoder;
 
     if ((writer == NULL) || (writer->out == NULL)) {
@@ -498,8 +517,7 @@ xmlTextWriterStartDocument(xmlTextWriter *writer, const char *version,
         return -1;
     }
 
-    lk = xmlListFront(writer->nodes);
-    if ((lk != NULL) && (xmlLinkGetData(lk) != NULL)) {
+    if (xmlTextWriterTop(writer) != NULL) {
         xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
                         "xmlTextWriterStartDocument : not allowed in this context!\n");
         return -1;
@@ -606,7 +624,6 @@ xmlTextWriterEndDocument(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL) {
@@ -616,10 +633,7 @@ xmlTextWriterEndDocument(xmlTextWriter *writer)
     }
 
     sum = 0;
-    while ((lk = xmlListFront(writer->nodes)) != NULL) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p == 0)
-            break;
+    while ((p = xmlTextWriterTop(writer)) != NULL) {
         switch (p->state) {
             case XML_TEXTWRITER_NAME:
             case XML_TEXTWRITER_ATTRIBUTE:
@@ -694,7 +708,6 @@ xmlTextWriterStartComment(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL) {
@@ -704,52 +717,43 @@ xmlTextWriterStartComment(xmlTextWriter *writer)
     }
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            switch (p->state) {
-                case XML_TEXTWRITER_TEXT:
-                case XML_TEXTWRITER_NONE:
-                    break;
-                case XML_TEXTWRITER_NAME:
-                    /* Output namespace declarations */
-                    count = xmlTextWriterOutputNSDecl(writer);
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    count = xmlOutputBufferWriteString(writer->out, ">");
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        switch (p->state) {
+            case XML_TEXTWRITER_TEXT:
+            case XML_TEXTWRITER_NONE:
+                break;
+            case XML_TEXTWRITER_NAME:
+                /* Output namespace declarations */
+                count = xmlTextWriterOutputNSDecl(writer);
+                if (count < 0)
+                    return -1;
+                sum += count;
+                count = xmlOutputBufferWriteString(writer->out, ">");
+                if (count < 0)
+                    return -1;
+                sum += count;
+                if (writer->indent) {
+                    count =
+                        xmlOutputBufferWriteString(writer->out, "\n");
                     if (count < 0)
                         return -1;
                     sum += count;
-                    if (writer->indent) {
-                        count =
-                            xmlOutputBufferWriteString(writer->out, "\n");
-                        if (count < 0)
-                            return -1;
-                        sum += count;
-                    }
-                    p->state = XML_TEXTWRITER_TEXT;
-                    break;
-                default:
-                    return -1;
-            }
+                }
+                p->state = XML_TEXTWRITER_TEXT;
+                break;
+            default:
+                return -1;
         }
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
+    p = xmlTextWriterPushEntry(writer, NULL, 0, XML_TEXTWRITER_COMMENT);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartElement : out of memory!\n");
         return -1;
     }
 
-    p->name = NULL;
-    p->state = XML_TEXTWRITER_COMMENT;
-
-    xmlListPushFront(writer->nodes, p);
-
     if (writer->indent) {
         count = xmlTextWriterWriteIndent(writer);
         if (count < 0)
@@ -776,7 +780,6 @@ xmlTextWriterEndComment(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL) {
@@ -785,15 +788,8 @@ xmlTextWriterEndComment(xmlTextWriter *writer)
         return -1;
     }
 
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
-                        "xmlTextWriterEndComment : not allowed in this context!\n");
-        return -1;
-    }
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     sum = 0;
@@ -815,7 +811,7 @@ xmlTextWriterEndComment(xmlTextWriter *writer)
         sum += count;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -904,80 +900,65 @@ xmlTextWriterWriteComment(xmlTextWriter *writer, const xmlChar * content)
 }
 
 /**
- * Start an xml element.
+ * Start an xml element. If `owned` is set, `name` was allocated by
+ * the caller and is handed over to the element stack. Otherwise it is
+ * referenced, which is only allowed for trusted writers.
  *
  * @param writer  the xmlTextWriter
  * @param name  element name
+ * @param owned  whether the name is handed over
  * @returns the bytes written (may be 0 because of buffering) or -1 in case of error
  */
-int
-xmlTextWriterStartElement(xmlTextWriter *writer, const xmlChar * name)
+static int
+xmlTextWriterStartElementInternal(xmlTextWriterPtr writer, xmlChar *name,
+                                  int owned)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
-    if ((writer == NULL) || (name == NULL) || (*name == '\0'))
-        return -1;
-
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            switch (p->state) {
-                case XML_TEXTWRITER_PI:
-                case XML_TEXTWRITER_PI_TEXT:
-                    return -1;
-                case XML_TEXTWRITER_NONE:
-                    break;
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        switch (p->state) {
+            case XML_TEXTWRITER_PI:
+            case XML_TEXTWRITER_PI_TEXT:
+                goto error;
+            case XML_TEXTWRITER_NONE:
+                break;
 				case XML_TEXTWRITER_ATTRIBUTE:
 					count = xmlTextWriterEndAttribute(writer);
 					if (count < 0)
-						return -1;
+						goto error;
 					sum += count;
 					/* fallthrough */
-                case XML_TEXTWRITER_NAME:
-                    /* Output namespace declarations */
-                    count = xmlTextWriterOutputNSDecl(writer);
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    count = xmlOutputBufferWriteString(writer->out, ">");
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    if (writer->indent)
-                        count =
-                            xmlOutputBufferWriteString(writer->out, "\n");
-                    p->state = XML_TEXTWRITER_TEXT;
-                    break;
-                default:
-                    break;
-            }
+            case XML_TEXTWRITER_NAME:
+                /* Output namespace declarations */
+                count = xmlTextWriterOutputNSDecl(writer);
+                if (count < 0)
+                    goto error;
+                sum += count;
+                count = xmlOutputBufferWriteString(writer->out, ">");
+                if (count < 0)
+                    goto error;
+                sum += count;
+                if (writer->indent)
+                    count =
+                        xmlOutputBufferWriteString(writer->out, "\n");
+                p->state = XML_TEXTWRITER_TEXT;
+                break;
+            default:
+                break;
         }
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
+    p = xmlTextWriterPushEntry(writer, name, owned, XML_TEXTWRITER_NAME);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartElement : out of memory!\n");
         return -1;
     }
 
-    p->name = xmlStrdup(name);
-    if (p->name == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
-                        "xmlTextWriterStartElement : out of memory!\n");
-        xmlFree(p);
-        return -1;
-    }
-    p->state = XML_TEXTWRITER_NAME;
-
-    xmlListPushFront(writer->nodes, p);
-
     if (writer->indent) {
         count = xmlTextWriterWriteIndent(writer);
         sum += count;
@@ -994,6 +975,39 @@ xmlTextWriterStartElement(xmlTextWriter *writer, const xmlChar * name)
     sum += count;
 
     return sum;
+
+error:
+    if (owned)
+        xmlFree(name);
+    return -1;
+}
+
+/**
+ * Start an xml element.
+ *
+ * @param writer  the xmlTextWriter
+ * @param name  element name
+ * @returns the bytes written (may be 0 because of buffering) or -1 in case of error
+ */
+int
+xmlTextWriterStartElement(xmlTextWriter *writer, const xmlChar * name)
+{
+    xmlChar *copy;
+
+    if ((writer == NULL) || (name == NULL) || (*name == '\0'))
+        return -1;
+
+    if (writer->trusted)
+        return xmlTextWriterStartElementInternal(writer, (xmlChar *) name, 0);
+
+    copy = xmlStrdup(name);
+    if (copy == NULL) {
+        xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
+                        "xmlTextWriterStartElement : out of memory!\n");
+        return -1;
+    }
+
+    return xmlTextWriterStartElementInternal(writer, copy, 1);
 }
 
 /**
@@ -1017,16 +1031,22 @@ xmlTextWriterStartElementNS(xmlTextWriter *writer,
     if ((writer == NULL) || (name == NULL) || (*name == '\0'))
         return -1;
 
-    buf = NULL;
+    sum = 0;
     if (prefix != 0) {
         buf = xmlStrdup(prefix);
         buf = xmlStrcat(buf, BAD_CAST ":");
-    }
-    buf = xmlStrcat(buf, name);
+        buf = xmlStrcat(buf, name);
+        if (buf == NULL) {
+            xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
+                            "xmlTextWriterStartElementNS : out of memory!\n");
+            return -1;
+        }
 
-    sum = 0;
-    count = xmlTextWriterStartElement(writer, buf);
-    xmlFree(buf);
+        /* The qualified name is built once and handed over */
+        count = xmlTextWriterStartElementInternal(writer, buf, 1);
+    } else {
+        count = xmlTextWriterStartElement(writer, name);
+    }
     if (count < 0)
         return -1;
     sum += count;
@@ -1054,7 +1074,7 @@ xmlTextWriterStartElementNS(xmlTextWriter *writer,
             xmlFree(p);
             return -1;
         }
-        p->elem = xmlListFront(writer->nodes);
+        p->elem = writer->nodeNr;
 
         xmlListPushFront(writer->nsstack, p);
     }
@@ -1073,21 +1093,13 @@ xmlTextWriterEndElement(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0) {
-        xmlListDelete(writer->nsstack);
-        writer->nsstack = NULL;
-        return -1;
-    }
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0) {
+    p = xmlTextWriterTop(writer);
+    if (p == NULL) {
         xmlListDelete(writer->nsstack);
         writer->nsstack = NULL;
         return -1;
@@ -1148,7 +1160,7 @@ xmlTextWriterEndElement(xmlTextWriter *writer)
         sum += count;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -1163,18 +1175,13 @@ xmlTextWriterFullEndElement(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0)
-        return -1;
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     sum = 0;
@@ -1229,7 +1236,7 @@ xmlTextWriterFullEndElement(xmlTextWriter *writer)
         sum += count;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -1299,7 +1306,6 @@ xmlTextWriterWriteRawLen(xmlTextWriter *writer, const xmlChar * content,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL) {
@@ -1315,9 +1321,8 @@ xmlTextWriterWriteRawLen(xmlTextWriter *writer, const xmlChar * content,
     }
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
         count = xmlTextWriterHandleStateDependencies(writer, p);
         if (count < 0)
             return -1;
@@ -1417,7 +1422,7 @@ xmlTextWriterWriteString(xmlTextWriter *writer, const xmlChar * content)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
+    size_t size, after;
     xmlTextWriterStackEntry *p;
     xmlChar *buf;
 
@@ -1426,26 +1431,38 @@ xmlTextWriterWriteString(xmlTextWriter *writer, const xmlChar * content)
 
     sum = 0;
     buf = (xmlChar *) content;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            switch (p->state) {
-                case XML_TEXTWRITER_NAME:
-                case XML_TEXTWRITER_TEXT:
-                    /*
-                     * TODO: Use xmlSerializeText
-                     */
-                    buf = xmlEncodeSpecialChars(NULL, content);
-                    break;
-                case XML_TEXTWRITER_ATTRIBUTE:
-                    buf = NULL;
-                    xmlBufAttrSerializeTxtContent(writer->out, writer->doc,
-                                                  content);
-                    break;
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        switch (p->state) {
+            case XML_TEXTWRITER_NAME:
+            case XML_TEXTWRITER_TEXT:
+                if (writer->out == NULL)
+                    return -1;
+                count = xmlTextWriterHandleStateDependencies(writer, p);
+                if (count < 0)
+                    return -1;
+                sum += count;
+                if (writer->indent)
+                    writer->doindent = 0;
+
+                /* Escape straight into the output buffer */
+                size = xmlTextWriterOutputSize(writer->out);
+                xmlSerializeText(writer->out, content, SIZE_MAX,
+                                 XML_ESCAPE_QUOT);
+                if (writer->out->error)
+                    return -1;
+                after = xmlTextWriterOutputSize(writer->out);
+                size = (after > size) ? after - size : 0;
+                if (size > (size_t) (INT_MAX - sum))
+                    return INT_MAX;
+                return sum + size;
+            case XML_TEXTWRITER_ATTRIBUTE:
+                buf = NULL;
+                xmlBufAttrSerializeTxtContent(writer->out, writer->doc,
+                                              content);
+                break;
 		default:
 		    break;
-            }
         }
     }
 
@@ -1558,22 +1575,18 @@ xmlTextWriterWriteBase64(xmlTextWriter *writer, const char *data,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if ((writer == NULL) || (data == NULL) || (start < 0) || (len < 0))
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            count = xmlTextWriterHandleStateDependencies(writer, p);
-            if (count < 0)
-                return -1;
-            sum += count;
-        }
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        count = xmlTextWriterHandleStateDependencies(writer, p);
+        if (count < 0)
+            return -1;
+        sum += count;
     }
 
     if (writer->indent)
@@ -1646,22 +1659,18 @@ xmlTextWriterWriteBinHex(xmlTextWriter *writer, const char *data,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if ((writer == NULL) || (data == NULL) || (start < 0) || (len < 0))
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            count = xmlTextWriterHandleStateDependencies(writer, p);
-            if (count < 0)
-                return -1;
-            sum += count;
-        }
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        count = xmlTextWriterHandleStateDependencies(writer, p);
+        if (count < 0)
+            return -1;
+        sum += count;
     }
 
     if (writer->indent)
@@ -1689,19 +1698,14 @@ xmlTextWriterStartAttribute(xmlTextWriter *writer, const xmlChar * name)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if ((writer == NULL) || (name == NULL) || (*name == '\0'))
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0)
-        return -1;
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     switch (p->state) {
@@ -1773,7 +1777,7 @@ xmlTextWriterStartAttributeNS(xmlTextWriter *writer,
 
         nsentry.prefix = buf;
         nsentry.uri = (xmlChar *)namespaceURI;
-        nsentry.elem = xmlListFront(writer->nodes);
+        nsentry.elem = writer->nodeNr;
 
         curns = (xmlTextWriterNsStackEntry *)xmlListSearch(writer->nsstack,
                                                            (void *)&nsentry);
@@ -1806,7 +1810,7 @@ xmlTextWriterStartAttributeNS(xmlTextWriter *writer,
                 xmlFree(p);
                 return -1;
             }
-            p->elem = xmlListFront(writer->nodes);
+            p->elem = writer->nodeNr;
 
             xmlListPushFront(writer->nsstack, p);
         }
@@ -1840,19 +1844,13 @@ xmlTextWriterEndAttribute(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0) {
-        return -1;
-    }
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0) {
+    p = xmlTextWriterTop(writer);
+    if (p == NULL) {
         return -1;
     }
 
@@ -2259,6 +2257,162 @@ xmlTextWriterWriteElementNS(xmlTextWriter *writer,
     return sum;
 }
 
+/**
+ * Write a batch of simple elements with attributes and text content.
+ * The elements become siblings in the current element or at the top
+ * level. This produces the same output as a sequence of calls to
+ * #xmlTextWriterStartElement, #xmlTextWriterWriteAttribute,
+ * #xmlTextWriterWriteString and #xmlTextWriterEndElement, but checks
+ * the writer state only once and doesn't use the element stack.
+ *
+ * An element without text is written as empty element tag.
+ *
+ * @since 2.16.0
+ *
+ * @param writer  the xmlTextWriter
+ * @param elems  array of elements
+ * @param nbElems  number of elements
+ * @returns the bytes written (may be 0 because of buffering) or -1 in case of error
+ */
+int
+xmlTextWriterWriteElements(xmlTextWriter *writer,
+                           const xmlTextWriterElement *elems, int nbElems)
+{
+    xmlOutputBufferPtr out;
+    xmlTextWriterStackEntry *p;
+    size_t size, after;
+    int count;
+    int sum;
+    int i, j;
+
+    if ((writer == NULL) || (writer->out == NULL) ||
+        ((elems == NULL) && (nbElems != 0)) || (nbElems < 0))
+        return -1;
+
+    /* Check the whole batch first to avoid partial output */
+    for (i = 0; i < nbElems; i++) {
+        const xmlTextWriterElement *elem = &elems[i];
+
+        if ((elem->name == NULL) || (*elem->name == '\0'))
+            return -1;
+        if (elem->attrs != NULL) {
+            for (j = 0; elem->attrs[j] != NULL; j += 2) {
+                if ((*elem->attrs[j] == '\0') || (elem->attrs[j+1] == NULL))
+                    return -1;
+            }
+        }
+    }
+
+    /* Indentation depends on the element stack */
+    if (writer->indent) {
+        sum = 0;
+        for (i = 0; i < nbElems; i++) {
+            const xmlTextWriterElement *elem = &elems[i];
+
+            count = xmlTextWriterStartElement(writer, elem->name);
+            if (count < 0)
+                return -1;
+            sum += count;
+            if (elem->attrs != NULL) {
+                for (j = 0; elem->attrs[j] != NULL; j += 2) {
+                    count = xmlTextWriterWriteAttribute(writer,
+                            elem->attrs[j], elem->attrs[j+1]);
+                    if (count < 0)
+                        return -1;
+                    sum += count;
+                }
+            }
+            if (elem->text != NULL) {
+                count = xmlTextWriterWriteString(writer, elem->text);
+                if (count < 0)
+                    return -1;
+                sum += count;
+            }
+            count = xmlTextWriterEndElement(writer);
+            if (count < 0)
+                return -1;
+            sum += count;
+        }
+        return sum;
+    }
+
+    sum = 0;
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        switch (p->state) {
+            case XML_TEXTWRITER_PI:
+            case XML_TEXTWRITER_PI_TEXT:
+                return -1;
+            case XML_TEXTWRITER_ATTRIBUTE:
+                count = xmlTextWriterEndAttribute(writer);
+                if (count < 0)
+                    return -1;
+                sum += count;
+                /* fallthrough */
+            case XML_TEXTWRITER_NAME:
+                /* Output namespace declarations */
+                count = xmlTextWriterOutputNSDecl(writer);
+                if (count < 0)
+                    return -1;
+                sum += count;
+                count = xmlOutputBufferWrite(writer->out, 1, ">");
+                if (count < 0)
+                    return -1;
+                sum += count;
+                p->state = XML_TEXTWRITER_TEXT;
+                break;
+            default:
+                break;
+        }
+    }
+
+    out = writer->out;
+    size = xmlTextWriterOutputSize(out);
+
+    for (i = 0; i < nbElems; i++) {
+        const xmlTextWriterElement *elem = &elems[i];
+        int nameLen = xmlStrlen(elem->name);
+
+        xmlOutputBufferWrite(out, 1, "<");
+        xmlOutputBufferWrite(out, nameLen, (const char *) elem->name);
+
+        if (elem->attrs != NULL) {
+            for (j = 0; elem->attrs[j] != NULL; j += 2) {
+                xmlOutputBufferWrite(out, 1, " ");
+                xmlOutputBufferWriteString(out, (const char *) elem->attrs[j]);
+                xmlOutputBufferWrite(out, 1, "=");
+                xmlOutputBufferWrite(out, 1, &writer->qchar);
+                xmlBufAttrSerializeTxtContent(out, writer->doc,
+                                              elem->attrs[j+1]);
+                xmlOutputBufferWrite(out, 1, &writer->qchar);
+            }
+        }
+
+        if (elem->text != NULL) {
+            xmlOutputBufferWrite(out, 1, ">");
+            xmlSerializeText(out, elem->text, SIZE_MAX, XML_ESCAPE_QUOT);
+            xmlOutputBufferWrite(out, 2, "</");
+            xmlOutputBufferWrite(out, nameLen, (const char *) elem->name);
+            xmlOutputBufferWrite(out, 1, ">");
+        } else {
+            xmlOutputBufferWrite(out, 2, "/>");
+        }
+
+        if (out->error)
+            return -1;
+
+        /* Like xmlTextWriterEndElement after text */
+        if (elem->text != NULL)
+            writer->doindent = 1;
+    }
+
+    after = xmlTextWriterOutputSize(out);
+    size = (after > size) ? after - size : 0;
+    if (size > (size_t) (INT_MAX - sum))
+        return INT_MAX;
+    return sum + size;
+}
+
 /**
  * Start an xml PI.
  *
@@ -2271,7 +2425,6 @@ xmlTextWriterStartPI(xmlTextWriter *writer, const xmlChar * target)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if ((writer == NULL) || (target == NULL) || (*target == '\0'))
@@ -2284,63 +2437,49 @@ xmlTextWriterStartPI(xmlTextWriter *writer, const xmlChar * target)
     }
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            switch (p->state) {
-                case XML_TEXTWRITER_ATTRIBUTE:
-                    count = xmlTextWriterEndAttribute(writer);
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    /* fallthrough */
-                case XML_TEXTWRITER_NAME:
-                    /* Output namespace declarations */
-                    count = xmlTextWriterOutputNSDecl(writer);
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    count = xmlOutputBufferWriteString(writer->out, ">");
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    p->state = XML_TEXTWRITER_TEXT;
-                    break;
-                case XML_TEXTWRITER_NONE:
-                case XML_TEXTWRITER_TEXT:
-                case XML_TEXTWRITER_DTD:
-                    break;
-                case XML_TEXTWRITER_PI:
-                case XML_TEXTWRITER_PI_TEXT:
-                    xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
-                                    "xmlTextWriterStartPI : nested PI!\n");
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        switch (p->state) {
+            case XML_TEXTWRITER_ATTRIBUTE:
+                count = xmlTextWriterEndAttribute(writer);
+                if (count < 0)
                     return -1;
-                default:
+                sum += count;
+                /* fallthrough */
+            case XML_TEXTWRITER_NAME:
+                /* Output namespace declarations */
+                count = xmlTextWriterOutputNSDecl(writer);
+                if (count < 0)
                     return -1;
-            }
+                sum += count;
+                count = xmlOutputBufferWriteString(writer->out, ">");
+                if (count < 0)
+                    return -1;
+                sum += count;
+                p->state = XML_TEXTWRITER_TEXT;
+                break;
+            case XML_TEXTWRITER_NONE:
+            case XML_TEXTWRITER_TEXT:
+            case XML_TEXTWRITER_DTD:
+                break;
+            case XML_TEXTWRITER_PI:
+            case XML_TEXTWRITER_PI_TEXT:
+                xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
+                                "xmlTextWriterStartPI : nested PI!\n");
+                return -1;
+            default:
+                return -1;
         }
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
+    p = xmlTextWriterPushEntry(writer,
+                               xmlStrdup(target), 1, XML_TEXTWRITER_PI);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartPI : out of memory!\n");
         return -1;
     }
 
-    p->name = xmlStrdup(target);
-    if (p->name == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
-                        "xmlTextWriterStartPI : out of memory!\n");
-        xmlFree(p);
-        return -1;
-    }
-    p->state = XML_TEXTWRITER_PI;
-
-    xmlListPushFront(writer->nodes, p);
-
     count = xmlOutputBufferWriteString(writer->out, "<?");
     if (count < 0)
         return -1;
@@ -2365,18 +2504,13 @@ xmlTextWriterEndPI(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0)
-        return 0;
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return 0;
 
     sum = 0;
@@ -2399,7 +2533,7 @@ xmlTextWriterEndPI(xmlTextWriter *writer)
         sum += count;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -2502,64 +2636,54 @@ xmlTextWriterStartCDATA(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            switch (p->state) {
-                case XML_TEXTWRITER_NONE:
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        switch (p->state) {
+            case XML_TEXTWRITER_NONE:
 		case XML_TEXTWRITER_TEXT:
-                case XML_TEXTWRITER_PI:
-                case XML_TEXTWRITER_PI_TEXT:
-                    break;
-                case XML_TEXTWRITER_ATTRIBUTE:
-                    count = xmlTextWriterEndAttribute(writer);
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    /* fallthrough */
-                case XML_TEXTWRITER_NAME:
-                    /* Output namespace declarations */
-                    count = xmlTextWriterOutputNSDecl(writer);
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    count = xmlOutputBufferWriteString(writer->out, ">");
-                    if (count < 0)
-                        return -1;
-                    sum += count;
-                    p->state = XML_TEXTWRITER_TEXT;
-                    break;
-                case XML_TEXTWRITER_CDATA:
-                    xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
-                                    "xmlTextWriterStartCDATA : CDATA not allowed in this context!\n");
+            case XML_TEXTWRITER_PI:
+            case XML_TEXTWRITER_PI_TEXT:
+                break;
+            case XML_TEXTWRITER_ATTRIBUTE:
+                count = xmlTextWriterEndAttribute(writer);
+                if (count < 0)
                     return -1;
-                default:
+                sum += count;
+                /* fallthrough */
+            case XML_TEXTWRITER_NAME:
+                /* Output namespace declarations */
+                count = xmlTextWriterOutputNSDecl(writer);
+                if (count < 0)
                     return -1;
-            }
+                sum += count;
+                count = xmlOutputBufferWriteString(writer->out, ">");
+                if (count < 0)
+                    return -1;
+                sum += count;
+                p->state = XML_TEXTWRITER_TEXT;
+                break;
+            case XML_TEXTWRITER_CDATA:
+                xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
+                                "xmlTextWriterStartCDATA : CDATA not allowed in this context!\n");
+                return -1;
+            default:
+                return -1;
         }
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
+    p = xmlTextWriterPushEntry(writer, NULL, 0, XML_TEXTWRITER_CDATA);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartCDATA : out of memory!\n");
         return -1;
     }
 
-    p->name = NULL;
-    p->state = XML_TEXTWRITER_CDATA;
-
-    xmlListPushFront(writer->nodes, p);
-
     count = xmlOutputBufferWriteString(writer->out, "<![CDATA[");
     if (count < 0)
         return -1;
@@ -2579,18 +2703,13 @@ xmlTextWriterEndCDATA(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0)
-        return -1;
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     sum = 0;
@@ -2605,7 +2724,7 @@ xmlTextWriterEndCDATA(xmlTextWriter *writer)
             return -1;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -2708,39 +2827,25 @@ xmlTextWriterStartDTD(xmlTextWriter *writer,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL || name == NULL || *name == '\0')
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if ((lk != NULL) && (xmlLinkGetData(lk) != NULL)) {
+    if (xmlTextWriterTop(writer) != NULL) {
         xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
                         "xmlTextWriterStartDTD : DTD allowed only in prolog!\n");
         return -1;
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
+    p = xmlTextWriterPushEntry(writer, xmlStrdup(name), 1, XML_TEXTWRITER_DTD);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartDTD : out of memory!\n");
         return -1;
     }
 
-    p->name = xmlStrdup(name);
-    if (p->name == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
-                        "xmlTextWriterStartDTD : out of memory!\n");
-        xmlFree(p);
-        return -1;
-    }
-    p->state = XML_TEXTWRITER_DTD;
-
-    xmlListPushFront(writer->nodes, p);
-
     count = xmlOutputBufferWriteString(writer->out, "<!DOCTYPE ");
     if (count < 0)
         return -1;
@@ -2842,7 +2947,6 @@ xmlTextWriterEndDTD(xmlTextWriter *writer)
     int loop;
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
@@ -2851,11 +2955,8 @@ xmlTextWriterEndDTD(xmlTextWriter *writer)
     sum = 0;
     loop = 1;
     while (loop) {
-        lk = xmlListFront(writer->nodes);
-        if (lk == NULL)
-            break;
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p == 0)
+        p = xmlTextWriterTop(writer);
+        if (p == NULL)
             break;
         switch (p->state) {
             case XML_TEXTWRITER_DTD_TEXT:
@@ -2874,7 +2975,7 @@ xmlTextWriterEndDTD(xmlTextWriter *writer)
                     count = xmlOutputBufferWriteString(writer->out, "\n");
                 }
 
-                xmlListPopFront(writer->nodes);
+                xmlTextWriterPopEntry(writer);
                 break;
             case XML_TEXTWRITER_DTD_ELEM:
             case XML_TEXTWRITER_DTD_ELEM_TEXT:
@@ -3018,20 +3119,14 @@ xmlTextWriterStartDTDElement(xmlTextWriter *writer, const xmlChar * name)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL || name == NULL || *name == '\0')
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0) {
-        return -1;
-    }
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p != 0) {
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
         switch (p->state) {
             case XML_TEXTWRITER_DTD:
                 count = xmlOutputBufferWriteString(writer->out, " [");
@@ -3054,24 +3149,13 @@ xmlTextWriterStartDTDElement(xmlTextWriter *writer, const xmlChar * name)
         }
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
-                        "xmlTextWriterStartDTDElement : out of memory!\n");
-        return -1;
-    }
-
-    p->name = xmlStrdup(name);
-    if (p->name == 0) {
+    p = xmlTextWriterPushEntry(writer,
+                               xmlStrdup(name), 1, XML_TEXTWRITER_DTD_ELEM);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartDTDElement : out of memory!\n");
-        xmlFree(p);
         return -1;
     }
-    p->state = XML_TEXTWRITER_DTD_ELEM;
-
-    xmlListPushFront(writer->nodes, p);
 
     if (writer->indent) {
         count = xmlTextWriterWriteIndent(writer);
@@ -3103,19 +3187,14 @@ xmlTextWriterEndDTDElement(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0)
-        return -1;
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     switch (p->state) {
@@ -3137,7 +3216,7 @@ xmlTextWriterEndDTDElement(xmlTextWriter *writer)
         sum += count;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -3245,20 +3324,14 @@ xmlTextWriterStartDTDAttlist(xmlTextWriter *writer, const xmlChar * name)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL || name == NULL || *name == '\0')
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0) {
-        return -1;
-    }
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p != 0) {
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
         switch (p->state) {
             case XML_TEXTWRITER_DTD:
                 count = xmlOutputBufferWriteString(writer->out, " [");
@@ -3281,24 +3354,13 @@ xmlTextWriterStartDTDAttlist(xmlTextWriter *writer, const xmlChar * name)
         }
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
-                        "xmlTextWriterStartDTDAttlist : out of memory!\n");
-        return -1;
-    }
-
-    p->name = xmlStrdup(name);
-    if (p->name == 0) {
+    p = xmlTextWriterPushEntry(writer,
+                               xmlStrdup(name), 1, XML_TEXTWRITER_DTD_ATTL);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartDTDAttlist : out of memory!\n");
-        xmlFree(p);
         return -1;
     }
-    p->state = XML_TEXTWRITER_DTD_ATTL;
-
-    xmlListPushFront(writer->nodes, p);
 
     if (writer->indent) {
         count = xmlTextWriterWriteIndent(writer);
@@ -3330,19 +3392,14 @@ xmlTextWriterEndDTDAttlist(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0)
-        return -1;
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     switch (p->state) {
@@ -3364,7 +3421,7 @@ xmlTextWriterEndDTDAttlist(xmlTextWriter *writer)
         sum += count;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -3474,65 +3531,46 @@ xmlTextWriterStartDTDEntity(xmlTextWriter *writer,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL || name == NULL || *name == '\0')
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk != 0) {
-
-        p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-        if (p != 0) {
-            switch (p->state) {
-                case XML_TEXTWRITER_DTD:
-                    count = xmlOutputBufferWriteString(writer->out, " [");
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
+        switch (p->state) {
+            case XML_TEXTWRITER_DTD:
+                count = xmlOutputBufferWriteString(writer->out, " [");
+                if (count < 0)
+                    return -1;
+                sum += count;
+                if (writer->indent) {
+                    count =
+                        xmlOutputBufferWriteString(writer->out, "\n");
                     if (count < 0)
                         return -1;
                     sum += count;
-                    if (writer->indent) {
-                        count =
-                            xmlOutputBufferWriteString(writer->out, "\n");
-                        if (count < 0)
-                            return -1;
-                        sum += count;
-                    }
-                    p->state = XML_TEXTWRITER_DTD_TEXT;
-                    /* fallthrough */
-                case XML_TEXTWRITER_DTD_TEXT:
-                case XML_TEXTWRITER_NONE:
-                    break;
-                default:
-                    return -1;
-            }
+                }
+                p->state = XML_TEXTWRITER_DTD_TEXT;
+                /* fallthrough */
+            case XML_TEXTWRITER_DTD_TEXT:
+            case XML_TEXTWRITER_NONE:
+                break;
+            default:
+                return -1;
         }
     }
 
-    p = (xmlTextWriterStackEntry *)
-        xmlMalloc(sizeof(xmlTextWriterStackEntry));
-    if (p == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
-                        "xmlTextWriterStartDTDElement : out of memory!\n");
-        return -1;
-    }
-
-    p->name = xmlStrdup(name);
-    if (p->name == 0) {
+    p = xmlTextWriterPushEntry(writer, xmlStrdup(name), 1,
+                               (pe != 0) ? XML_TEXTWRITER_DTD_PENT :
+                                           XML_TEXTWRITER_DTD_ENTY);
+    if (p == NULL) {
         xmlWriterErrMsg(writer, XML_ERR_NO_MEMORY,
                         "xmlTextWriterStartDTDElement : out of memory!\n");
-        xmlFree(p);
         return -1;
     }
 
-    if (pe != 0)
-        p->state = XML_TEXTWRITER_DTD_PENT;
-    else
-        p->state = XML_TEXTWRITER_DTD_ENTY;
-
-    xmlListPushFront(writer->nodes, p);
-
     if (writer->indent) {
         count = xmlTextWriterWriteIndent(writer);
         if (count < 0)
@@ -3571,19 +3609,14 @@ xmlTextWriterEndDTDEntity(xmlTextWriter *writer)
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL)
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0)
-        return -1;
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     switch (p->state) {
@@ -3611,7 +3644,7 @@ xmlTextWriterEndDTDEntity(xmlTextWriter *writer)
         sum += count;
     }
 
-    xmlListPopFront(writer->nodes);
+    xmlTextWriterPopEntry(writer);
     return sum;
 }
 
@@ -3815,7 +3848,6 @@ xmlTextWriterWriteDTDExternalEntityContents(xmlTextWriter *writer,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL) {
@@ -3825,15 +3857,8 @@ xmlTextWriterWriteDTDExternalEntityContents(xmlTextWriter *writer,
     }
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0) {
-        xmlWriterErrMsg(writer, XML_ERR_INTERNAL_ERROR,
-                        "xmlTextWriterWriteDTDExternalEntityContents: you must call xmlTextWriterStartDTDEntity before the call to this function!\n");
-        return -1;
-    }
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
+    p = xmlTextWriterTop(writer);
+    if (p == NULL)
         return -1;
 
     switch (p->state) {
@@ -3944,20 +3969,14 @@ xmlTextWriterWriteDTDNotation(xmlTextWriter *writer,
 {
     int count;
     int sum;
-    xmlLinkPtr lk;
     xmlTextWriterStackEntry *p;
 
     if (writer == NULL || name == NULL || *name == '\0')
         return -1;
 
     sum = 0;
-    lk = xmlListFront(writer->nodes);
-    if (lk == 0) {
-        return -1;
-    }
-
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p != 0) {
+    p = xmlTextWriterTop(writer);
+    if (p != NULL) {
         switch (p->state) {
             case XML_TEXTWRITER_DTD:
                 count = xmlOutputBufferWriteString(writer->out, " [");
@@ -4103,56 +4122,74 @@ xmlTextWriterClose(xmlTextWriter *writer)
  */
 
 /**
- * Free callback for the xmlList.
+ * Push an entry on the element stack. Entries are stored by value in
+ * a growing array, so pointers to them are only valid until the next
+ * push.
  *
- * @param lk  the xmlLink
+ * If `owned` is set, the entry takes ownership of `name` which is
+ * freed on error. A NULL name with `owned` set is the result of a
+ * failed copy and also reported as error.
+ *
+ * @param writer  the xmlTextWriter
+ * @param name  the name of the entry or NULL
+ * @param owned  whether the entry owns the name
+ * @param state  the initial state
+ * @returns the new entry or NULL if a memory allocation failed
  */
-static void
-xmlFreeTextWriterStackEntry(xmlLinkPtr lk)
+static xmlTextWriterStackEntry *
+xmlTextWriterPushEntry(xmlTextWriterPtr writer, xmlChar *name, int owned,
+                       xmlTextWriterState state)
 {
     xmlTextWriterStackEntry *p;
 
-    p = (xmlTextWriterStackEntry *) xmlLinkGetData(lk);
-    if (p == 0)
-        return;
+    if ((owned) && (name == NULL))
+        return(NULL);
+
+    if (writer->nodeNr >= writer->nodeMax) {
+        xmlTextWriterStackEntry *tmp;
+        int newSize;
+
+        newSize = xmlGrowCapacity(writer->nodeMax, sizeof(tmp[0]),
+                                  10, XML_MAX_ITEMS);
+        if (newSize < 0)
+            goto error;
+        tmp = xmlRealloc(writer->nodeTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL)
+            goto error;
+        writer->nodeTab = tmp;
+        writer->nodeMax = newSize;
+    }
 
-    if (p->name != 0)
-        xmlFree(p->name);
-    xmlFree(p);
+    p = &writer->nodeTab[writer->nodeNr++];
+    p->name = name;
+    p->state = state;
+    p->owned = owned;
+    return(p);
+
+error:
+    if (owned)
+        xmlFree(name);
+    return(NULL);
 }
 
 /**
- * Compare callback for the xmlList.
+ * Pop the innermost entry from the element stack.
  *
- * @param data0  the first data
- * @param data1  the second data
- * @returns -1, 0, 1
+ * @param writer  the xmlTextWriter
  */
-static int
-xmlCmpTextWriterStackEntry(const void *data0, const void *data1)
+static void
+xmlTextWriterPopEntry(xmlTextWriterPtr writer)
 {
-    xmlTextWriterStackEntry *p0;
-    xmlTextWriterStackEntry *p1;
-
-    if (data0 == data1)
-        return 0;
-
-    if (data0 == 0)
-        return -1;
-
-    if (data1 == 0)
-        return 1;
+    xmlTextWriterStackEntry *p;
 
-    p0 = (xmlTextWriterStackEntry *) data0;
-    p1 = (xmlTextWriterStackEntry *) data1;
+    if (writer->nodeNr <= 0)
+        return;
 
-    return xmlStrcmp(p0->name, p1->name);
+    p = &writer->nodeTab[--writer->nodeNr];
+    if (p->owned)
+        xmlFree(p->name);
 }
 
-/**
- * misc
- */
-
 /**
  * Output the current namespace declarations.
  *
@@ -4451,6 +4488,30 @@ xmlTextWriterSetQuoteChar(xmlTextWriter *writer, xmlChar quotechar)
     return 0;
 }
 
+/**
+ * Trust the caller to keep element names alive. A trusted writer
+ * references the names passed to #xmlTextWriterStartElement and the
+ * unprefixed names passed to #xmlTextWriterStartElementNS until the
+ * element is ended instead of copying them. This saves an allocation
+ * per element when names are static strings or dictionary entries.
+ *
+ * @since 2.16.0
+ *
+ * @param writer  the xmlTextWriter
+ * @param trusted  whether names outlive their elements
+ * @returns -1 on error or 0 otherwise.
+ */
+int
+xmlTextWriterSetTrusted(xmlTextWriter *writer, int trusted)
+{
+    if (writer == NULL)
+        return -1;
+
+    writer->trusted = trusted ? 1 : 0;
+
+    return 0;
+}
+
 /**
  * Write indent string.
  *
@@ -4464,7 +4525,7 @@ xmlTextWriterWriteIndent(xmlTextWriterPtr writer)
     int i;
     int ret;
 
-    lksize = xmlListSize(writer->nodes);
+    lksize = writer->nodeNr;
     if (lksize < 1)
         return (-1);            /* list is empty */
     for (i = 0; i < (lksize - 1); i++) {
@@ -27,6 +27,7 @@
 #include <math.h>
 #include <float.h>
 #include <ctype.h>
+#include <time.h>
 
 #include <libxml/xmlmemory.h>
 #include <libxml/tree.h>
@@ -45,10 +46,18 @@
 
 #include "private/buf.h"
 #include "private/error.h"
+#include "private/globals.h"
 #include "private/memory.h"
 #include "private/parser.h"
+#include "private/threads.h"
+#include "private/trace.h"
+#include "private/tree.h"
 #include "private/xpath.h"
 
+#if defined(LIBXML_THREAD_ENABLED) && !defined(_WIN32)
+  #define XPATH_PARALLEL
+#endif
+
 /* Disabled for now */
 #if 0
 #ifdef LIBXML_PATTERN_ENABLED
@@ -104,6 +113,18 @@
  */
 #define XPATH_MAX_NODESET_LENGTH 10000000
 
+/*
+ * Default minimum size of node-sets filtered in parallel, see
+ * xmlXPathContextSetParallel.
+ */
+#define XPATH_PARALLEL_MIN_NODES 10000
+
+/*
+ * Minimum number of nodes evaluated by a single thread when filtering
+ * in parallel.
+ */
+#define XPATH_PARALLEL_MIN_CHUNK 1000
+
 /*
  * Maximum amount of nested functions calls when parsing or evaluating
  * expressions
@@ -165,13 +186,17 @@ static const struct {
 #define NUM_STANDARD_FUNCTIONS \
     (sizeof(xmlXPathStandardFunctions) / sizeof(xmlXPathStandardFunctions[0]))
 
-#define SF_HASH_SIZE 64
-
-static unsigned char xmlXPathSFHash[SF_HASH_SIZE];
+#include "codegen/xpathfuncs.inc"
 
+#if defined(NAN) && defined(INFINITY)
+double xmlXPathNAN = NAN;
+double xmlXPathPINF = INFINITY;
+double xmlXPathNINF = -INFINITY;
+#else
 double xmlXPathNAN = 0.0;
 double xmlXPathPINF = 0.0;
 double xmlXPathNINF = 0.0;
+#endif
 
 /**
  * @deprecated Alias for #xmlInitParser.
@@ -193,45 +218,39 @@ xmlXPathSFComputeHash(const xmlChar *name) {
     return(hashValue);
 }
 
+/*
+ * Protects the profile counters of compiled expressions, which are
+ * the only part updated by evaluations.
+ */
+static xmlMutex xmlXPathProfileMutex;
+
 /**
  * Initialize the XPath environment
  */
 ATTRIBUTE_NO_SANITIZE("float-divide-by-zero")
 void
 xmlInitXPathInternal(void) {
-    size_t i;
-
-#if defined(NAN) && defined(INFINITY)
-    xmlXPathNAN = NAN;
-    xmlXPathPINF = INFINITY;
-    xmlXPathNINF = -INFINITY;
-#else
+    /*
+     * The constants are initialized statically if possible and the
+     * hash table for standard functions is generated, so there's
+     * nothing to write at startup.
+     */
+#if !defined(NAN) || !defined(INFINITY)
     /* MSVC doesn't allow division by zero in constant expressions. */
     double zero = 0.0;
     xmlXPathNAN = 0.0 / zero;
     xmlXPathPINF = 1.0 / zero;
     xmlXPathNINF = -xmlXPathPINF;
 #endif
+    xmlInitMutex(&xmlXPathProfileMutex);
+}
 
-    /*
-     * Initialize hash table for standard functions
-     */
-
-    for (i = 0; i < SF_HASH_SIZE; i++)
-        xmlXPathSFHash[i] = UCHAR_MAX;
-
-    for (i = 0; i < NUM_STANDARD_FUNCTIONS; i++) {
-        const char *name = xmlXPathStandardFunctions[i].name;
-        int bucketIndex = xmlXPathSFComputeHash(BAD_CAST name) % SF_HASH_SIZE;
-
-        while (xmlXPathSFHash[bucketIndex] != UCHAR_MAX) {
-            bucketIndex += 1;
-            if (bucketIndex >= SF_HASH_SIZE)
-                bucketIndex = 0;
-        }
-
-        xmlXPathSFHash[bucketIndex] = i;
-    }
+/**
+ * Free the XPath environment
+ */
+void
+xmlCleanupXPathInternal(void) {
+    xmlCleanupMutex(&xmlXPathProfileMutex);
 }
 
 /************************************************************************
@@ -618,6 +637,46 @@ int wrap_cmp( xmlNodePtr x, xmlNodePtr y );
 #include "timsort.h"
 #endif /* WITH_TIM_SORT */
 
+/*
+ * Node with its key from the document order table of the name index,
+ * see xmlDocIndexNodeOrder.
+ */
+typedef struct {
+    int key;
+    xmlNodePtr node;
+} xmlXPathOrderKey;
+
+#define SORT_NAME libxml_orderkey
+#define SORT_TYPE xmlXPathOrderKey
+#define SORT_CMP(x, y)  ((x).key < (y).key ? -1 : ((x).key > (y).key))
+#include "timsort.h"
+
+/*
+ * Minimum size of node-sets sorted and merged by document order keys.
+ * Smaller sets are cheaper to handle by comparing nodes.
+ */
+#define XP_ORDER_KEYS_MIN 64
+
+/*
+ * Minimum size of both node-sets merged by looking up the nodes of the
+ * first set in a hash table.
+ */
+#define XP_HASH_MERGE_MIN 32
+
+/*
+ * Number of nodes stored inline after node-sets created by
+ * xmlXPathNodeSetCreate. Most intermediate sets are small and never
+ * need a separate nodeTab.
+ */
+#define XP_NODESET_INLINE 4
+#define XP_NODESET_INLINE_TAB(set) ((xmlNodePtr *) ((set) + 1))
+
+static void
+xmlXPathNodeSetFreeTab(xmlNodeSetPtr set) {
+    if (set->nodeTab != XP_NODESET_INLINE_TAB(set))
+        xmlFree(set->nodeTab);
+}
+
 /************************************************************************
  *									*
  *			Error handling routines				*
@@ -663,6 +722,8 @@ static const char* const xmlXPathErrorMessages[] = {
     "Forbidden variable",
     "Operation limit exceeded",
     "Recursion limit exceeded",
+    "Time limit exceeded",
+    "Evaluation cancelled",
     "?? Unknown error ??"	/* Must be last in the list! */
 };
 #define MAXERRNO ((int)(sizeof(xmlXPathErrorMessages) /	\
@@ -792,9 +853,15 @@ xmlXPatherror(xmlXPathParserContext *ctxt, const char *file ATTRIBUTE_UNUSED,
     xmlXPathErr(ctxt, no);
 }
 
+/*
+ * Number of operations between reads of the clock
+ */
+#define XPATH_CLOCK_INTERVAL 1024
+
 /**
  * Adds opCount to the running total of operations and returns -1 if the
- * operation limit is exceeded. Returns 0 otherwise.
+ * operation limit is exceeded, the time limit has passed or the
+ * evaluation was cancelled. Returns 0 otherwise.
  *
  * @param ctxt  the XPath Parser context
  * @param opCount  the number of operations to be added
@@ -802,20 +869,51 @@ xmlXPatherror(xmlXPathParserContext *ctxt, const char *file ATTRIBUTE_UNUSED,
 static int
 xmlXPathCheckOpLimit(xmlXPathParserContextPtr ctxt, unsigned long opCount) {
     xmlXPathContextPtr xpctxt = ctxt->context;
+    unsigned long prev = xpctxt->opCount;
 
-    if ((opCount > xpctxt->opLimit) ||
-        (xpctxt->opCount > xpctxt->opLimit - opCount)) {
+    if ((xpctxt->opLimit != 0) &&
+        ((opCount > xpctxt->opLimit) ||
+         (xpctxt->opCount > xpctxt->opLimit - opCount))) {
         xpctxt->opCount = xpctxt->opLimit;
         xmlXPathErr(ctxt, XPATH_OP_LIMIT_EXCEEDED);
         return(-1);
     }
 
     xpctxt->opCount += opCount;
+
+    if ((xpctxt->cancel != NULL) && (*xpctxt->cancel != 0)) {
+        xmlXPathErr(ctxt, XPATH_CANCELLED);
+        return(-1);
+    }
+    if ((xpctxt->timeLimit != 0) &&
+        ((opCount >= XPATH_CLOCK_INTERVAL) ||
+         (prev / XPATH_CLOCK_INTERVAL !=
+          xpctxt->opCount / XPATH_CLOCK_INTERVAL)) &&
+        ((long) (xmlMonotonicTimeMs() - xpctxt->deadline) >= 0)) {
+        xmlXPathErr(ctxt, XPATH_TIME_LIMIT_EXCEEDED);
+        return(-1);
+    }
+
     return(0);
 }
 
+#define XP_HAS_LIMITS(xpctxt) \
+    (((xpctxt)->opLimit != 0) || ((xpctxt)->timeLimit != 0) || \
+     ((xpctxt)->cancel != NULL))
+
 #define OP_LIMIT_EXCEEDED(ctxt, n) \
-    ((ctxt->context->opLimit != 0) && (xmlXPathCheckOpLimit(ctxt, n) < 0))
+    ((XP_HAS_LIMITS(ctxt->context)) && (xmlXPathCheckOpLimit(ctxt, n) < 0))
+
+/**
+ * Start the time limit of an evaluation.
+ *
+ * @param ctxt  the XPath context
+ */
+static void
+xmlXPathStartDeadline(xmlXPathContextPtr ctxt) {
+    if (ctxt->timeLimit != 0)
+        ctxt->deadline = xmlMonotonicTimeMs() + ctxt->timeLimit;
+}
 
 /************************************************************************
  *									*
@@ -880,6 +978,23 @@ typedef enum {
     NODE_TYPE_PI = XML_PI_NODE
 } xmlXPathTypeVal;
 
+/*
+ * Location steps without predicates which have a specialized
+ * evaluator, see xmlXPathNodeCollectFast, and other operations
+ * rewritten by xmlXPathOptimizeCompExpr.
+ */
+typedef enum {
+    XPATH_FAST_NONE = 0,
+    XPATH_FAST_CHILD_NAME,
+    XPATH_FAST_ATTRIBUTE_NAME,
+    XPATH_FAST_DESCENDANT_NAME,
+    XPATH_FAST_CHILD_TEXT,
+    /* "count(x) > 0" and similar comparisons, see xmlXPathCompOpEvalExists */
+    XPATH_FAST_EXISTS,
+    /* "[position() = last()]" and "[last()]" predicate expressions */
+    XPATH_FAST_LAST
+} xmlXPathFastStep;
+
 typedef struct _xmlXPathStepOp xmlXPathStepOp;
 typedef xmlXPathStepOp *xmlXPathStepOpPtr;
 struct _xmlXPathStepOp {
@@ -891,10 +1006,22 @@ struct _xmlXPathStepOp {
     int value3;
     void *value4;
     void *value5;
-    xmlXPathFunction cache;
-    void *cacheURI;
+    xmlXPathFunction cache;	/* standard function bound at compile time */
+    int fast;			/* xmlXPathFastStep of the op */
+    int invariant;		/* slot of a context independent value */
 };
 
+/*
+ * Counters of an operation, collected if the context has the
+ * XML_XPATH_PROFILE flag.
+ */
+typedef struct {
+    unsigned long count;	/* Number of evaluations */
+    unsigned long visited;	/* Number of nodes traversed by the axis */
+    unsigned long produced;	/* Number of nodes in the results */
+    double time;		/* Seconds spent, including the operands */
+} xmlXPathOpProfile;
+
 struct _xmlXPathCompExpr {
     int nbStep;			/* Number of steps in this expression */
     int maxStep;		/* Maximum number of steps allocated */
@@ -902,6 +1029,8 @@ struct _xmlXPathCompExpr {
     int last;			/* index of last step in expression */
     xmlChar *expr;		/* the expression being computed */
     xmlDictPtr dict;		/* the dictionary to use if any */
+    xmlXPathOpProfile *profile;	/* counters for each step if any */
+    int nbInvariant;		/* number of context independent values */
 #ifdef XPATH_STREAMING
     xmlPatternPtr stream;
 #endif
@@ -919,11 +1048,16 @@ static int
 xmlXPathCompOpEvalFirst(xmlXPathParserContextPtr ctxt,
                         xmlXPathStepOpPtr op, xmlNodePtr *first);
 static int
+xmlXPathIterAggregate(xmlXPathParserContextPtr pctxt, int toBool,
+                      int *boolRes);
+static int
 xmlXPathCompOpEvalToBoolean(xmlXPathParserContextPtr ctxt,
 			    xmlXPathStepOpPtr op,
 			    int isPredicate);
 static void
 xmlXPathFreeObjectEntry(void *obj, const xmlChar *name);
+static void
+xmlXPathFreeKeys(xmlXPathContextPtr ctxt);
 
 /************************************************************************
  *									*
@@ -996,6 +1130,8 @@ xmlXPathFreeCompExpr(xmlXPathCompExpr *comp)
 	}
         xmlDictFree(comp->dict);
     }
+    if (comp->profile != NULL)
+        xmlFree(comp->profile);
     if (comp->steps != NULL) {
         xmlFree(comp->steps);
     }
@@ -1011,6 +1147,27 @@ xmlXPathFreeCompExpr(xmlXPathCompExpr *comp)
     xmlFree(comp);
 }
 
+/**
+ * Check whether a compiled expression references variables. The
+ * result of other expressions only depends on the context.
+ *
+ * @param comp  an XPath compiled expression
+ * @returns 1 if `comp` references a variable, 0 otherwise.
+ */
+int
+xmlXPathCompExprUsesVariables(xmlXPathCompExpr *comp)
+{
+    int i;
+
+    if (comp == NULL)
+        return(0);
+    for (i = 0; i < comp->nbStep; i++) {
+        if (comp->steps[i].op == XPATH_OP_VARIABLE)
+            return(1);
+    }
+    return(0);
+}
+
 /**
  * Add a step to an XPath Compiled Expression
  *
@@ -1075,6 +1232,8 @@ xmlXPathCompExprAdd(xmlXPathParserContextPtr ctxt, int ch1, int ch2,
 	comp->steps[comp->nbStep].value5 = value5;
     }
     comp->steps[comp->nbStep].cache = NULL;
+    comp->steps[comp->nbStep].fast = XPATH_FAST_NONE;
+    comp->steps[comp->nbStep].invariant = 0;
     return(comp->nbStep++);
 }
 
@@ -1103,6 +1262,12 @@ xmlXPathCompExprAdd(ctxt, (ch1), (ch2), (op),			\
 
 /* #define XP_DEFAULT_CACHE_ON */
 
+/*
+ * Maximum number of objects per slot which are kept for the current
+ * thread when a context is freed, see xmlXPathSetThreadCacheSize.
+ */
+static int xmlXPathThreadCacheMax = 0;
+
 typedef struct _xmlXPathContextCache xmlXPathContextCache;
 typedef xmlXPathContextCache *xmlXPathContextCachePtr;
 struct _xmlXPathContextCache {
@@ -1289,7 +1454,7 @@ xmlXPathDebugDumpObject(FILE *output, xmlXPathObject *cur, int depth) {
 
 static void
 xmlXPathDebugDumpStepOp(FILE *output, xmlXPathCompExprPtr comp,
-	                     xmlXPathStepOpPtr op, int depth) {
+	                     xmlXPathStepOpPtr op, int depth, int profile) {
     int i;
     char shift[100];
 
@@ -1451,6 +1616,13 @@ xmlXPathDebugDumpStepOp(FILE *output, xmlXPathCompExprPtr comp,
 	default:
         fprintf(output, "UNKNOWN %d\n", op->op); return;
     }
+    if ((profile) && (comp->profile != NULL)) {
+        xmlXPathOpProfile *prof = &comp->profile[op - comp->steps];
+
+        fprintf(output, "  [evals %lu, visited %lu, produced %lu, %.3f ms]",
+                prof->count, prof->visited, prof->produced,
+                prof->time * 1000.0);
+    }
     fprintf(output, "\n");
 finish:
     /* OP_VALUE has invalid ch1. */
@@ -1458,9 +1630,11 @@ finish:
         return;
 
     if (op->ch1 >= 0)
-	xmlXPathDebugDumpStepOp(output, comp, &comp->steps[op->ch1], depth + 1);
+	xmlXPathDebugDumpStepOp(output, comp, &comp->steps[op->ch1], depth + 1,
+                                profile);
     if (op->ch2 >= 0)
-	xmlXPathDebugDumpStepOp(output, comp, &comp->steps[op->ch2], depth + 1);
+	xmlXPathDebugDumpStepOp(output, comp, &comp->steps[op->ch2], depth + 1,
+                                profile);
 }
 
 /**
@@ -1493,12 +1667,343 @@ xmlXPathDebugDumpCompExpr(FILE *output, xmlXPathCompExpr *comp,
         fprintf(output, "Compiled Expression : %d elements\n",
                 comp->nbStep);
         i = comp->last;
-        xmlXPathDebugDumpStepOp(output, comp, &comp->steps[i], depth + 1);
+        xmlXPathDebugDumpStepOp(output, comp, &comp->steps[i], depth + 1, 0);
+    }
+}
+
+/**
+ * Dumps the tree of the compiled XPath expression annotated with the
+ * counters collected during evaluations with a context that has the
+ * #XML_XPATH_PROFILE flag. For each operation, the number of
+ * evaluations, the number of nodes traversed by its axis, the total
+ * size of its resulting node-sets and the time spent including its
+ * operands are shown. The counters accumulate until the expression
+ * is freed.
+ *
+ * @since 2.16.0
+ *
+ * @param output  the FILE * for the output
+ * @param comp  the precompiled XPath expression
+ * @param depth  the indentation level.
+ */
+void
+xmlXPathDebugDumpProfile(FILE *output, xmlXPathCompExpr *comp,
+	                 int depth) {
+    int i;
+    char shift[100];
+
+    if ((output == NULL) || (comp == NULL)) return;
+
+    for (i = 0;((i < depth) && (i < 25));i++)
+        shift[2 * i] = shift[2 * i + 1] = ' ';
+    shift[2 * i] = shift[2 * i + 1] = 0;
+
+    fprintf(output, "%s", shift);
+
+    xmlMutexLock(&xmlXPathProfileMutex);
+    if (comp->profile == NULL) {
+        fprintf(output, "No profile\n");
+    } else {
+        fprintf(output, "Profile : %d elements\n", comp->nbStep);
+        i = comp->last;
+        xmlXPathDebugDumpStepOp(output, comp, &comp->steps[i], depth + 1, 1);
     }
+    xmlMutexUnlock(&xmlXPathProfileMutex);
 }
 
 #endif /* LIBXML_DEBUG_ENABLED */
 
+/************************************************************************
+ *									*
+ *			Compiled expression cache			*
+ *									*
+ ************************************************************************/
+
+/*
+ * Expressions evaluated from strings are compiled once and kept in an
+ * LRU cache on the context. Compilation only depends on the context
+ * flags and dictionary, but evaluation caches function pointers and
+ * namespace URIs in the compiled steps. So the cache is flushed when
+ * functions or namespaces are registered.
+ *
+ * An entry can be in use while an extension function evaluates
+ * another expression with the same context. Such entries are never
+ * freed, only detached and freed after the outer evaluation.
+ */
+typedef struct _xmlXPathExprCacheEntry xmlXPathExprCacheEntry;
+struct _xmlXPathExprCacheEntry {
+    xmlXPathExprCacheEntry *prev;
+    xmlXPathExprCacheEntry *next;
+    xmlXPathCompExprPtr comp;
+    int busy;
+    /* detached from the cache, free when no longer busy */
+    int detached;
+};
+
+typedef struct {
+    xmlHashTablePtr hash;
+    /* most recently used first */
+    xmlXPathExprCacheEntry *first;
+    xmlXPathExprCacheEntry *last;
+    int nbEntries;
+    int maxEntries;
+    /* settings the cached expressions were compiled with */
+    int flags;
+    xmlDictPtr dict;
+} xmlXPathExprCache;
+
+static void
+xmlXPathExprCacheFreeEntry(xmlXPathExprCacheEntry *entry) {
+    xmlXPathFreeCompExpr(entry->comp);
+    xmlFree(entry);
+}
+
+static void
+xmlXPathExprCacheUnlink(xmlXPathExprCache *cache,
+                        xmlXPathExprCacheEntry *entry) {
+    if (entry->prev != NULL)
+        entry->prev->next = entry->next;
+    else
+        cache->first = entry->next;
+    if (entry->next != NULL)
+        entry->next->prev = entry->prev;
+    else
+        cache->last = entry->prev;
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+/**
+ * Remove an entry from the cache and free it unless it's in use.
+ *
+ * @param cache  the expression cache
+ * @param entry  the entry to remove
+ */
+static void
+xmlXPathExprCacheRemove(xmlXPathExprCache *cache,
+                        xmlXPathExprCacheEntry *entry) {
+    xmlXPathExprCacheUnlink(cache, entry);
+    xmlHashRemoveEntry(cache->hash, entry->comp->expr, NULL);
+    cache->nbEntries -= 1;
+
+    if (entry->busy > 0)
+        entry->detached = 1;
+    else
+        xmlXPathExprCacheFreeEntry(entry);
+}
+
+/**
+ * Evict entries until at most `max` are left. Entries in use are
+ * skipped.
+ *
+ * @param cache  the expression cache
+ * @param max  maximum number of entries to keep
+ */
+static void
+xmlXPathExprCacheTrim(xmlXPathExprCache *cache, int max) {
+    xmlXPathExprCacheEntry *entry = cache->last;
+
+    while ((entry != NULL) && (cache->nbEntries > max)) {
+        xmlXPathExprCacheEntry *prev = entry->prev;
+
+        if (entry->busy == 0)
+            xmlXPathExprCacheRemove(cache, entry);
+        entry = prev;
+    }
+}
+
+/**
+ * Flush the compiled expression cache of a context.
+ *
+ * @param ctxt  the XPath context
+ */
+static void
+xmlXPathExprCacheClear(xmlXPathContextPtr ctxt) {
+    xmlXPathExprCache *cache = ctxt->exprCache;
+
+    if (cache == NULL)
+        return;
+
+    while (cache->first != NULL)
+        xmlXPathExprCacheRemove(cache, cache->first);
+}
+
+/**
+ * Look up a compiled expression or compile and cache it.
+ *
+ * @param ctxt  the XPath context with an expression cache
+ * @param str  the XPath expression
+ * @returns the cache entry or NULL if the expression failed to
+ * compile. The entry is marked busy.
+ */
+static xmlXPathExprCacheEntry *
+xmlXPathExprCacheGet(xmlXPathContextPtr ctxt, const xmlChar *str) {
+    xmlXPathExprCache *cache = ctxt->exprCache;
+    xmlXPathExprCacheEntry *entry;
+    xmlXPathCompExprPtr comp;
+
+    if ((cache->flags != ctxt->flags) || (cache->dict != ctxt->dict)) {
+        xmlXPathExprCacheClear(ctxt);
+        cache->flags = ctxt->flags;
+        cache->dict = ctxt->dict;
+    }
+
+    entry = xmlHashLookup(cache->hash, str);
+    if (entry != NULL) {
+        if (entry != cache->first) {
+            xmlXPathExprCacheUnlink(cache, entry);
+            entry->next = cache->first;
+            cache->first->prev = entry;
+            cache->first = entry;
+        }
+        entry->busy += 1;
+        return(entry);
+    }
+
+    comp = xmlXPathCtxtCompile(ctxt, str);
+    if (comp == NULL)
+        return(NULL);
+
+    entry = xmlMalloc(sizeof(*entry));
+    if ((entry == NULL) || (comp->expr == NULL)) {
+        xmlXPathErrMemory(ctxt);
+        xmlFree(entry);
+        xmlXPathFreeCompExpr(comp);
+        return(NULL);
+    }
+    memset(entry, 0, sizeof(*entry));
+    entry->comp = comp;
+    entry->busy = 1;
+
+    xmlXPathExprCacheTrim(cache, cache->maxEntries - 1);
+
+    if ((cache->nbEntries >= cache->maxEntries) ||
+        (xmlHashAddEntry(cache->hash, comp->expr, entry) < 0)) {
+        /* Use the expression once without caching it */
+        entry->detached = 1;
+        return(entry);
+    }
+
+    entry->next = cache->first;
+    if (cache->first != NULL)
+        cache->first->prev = entry;
+    else
+        cache->last = entry;
+    cache->first = entry;
+    cache->nbEntries += 1;
+
+    return(entry);
+}
+
+static void
+xmlXPathExprCacheRelease(xmlXPathExprCacheEntry *entry) {
+    entry->busy -= 1;
+    if ((entry->busy == 0) && (entry->detached))
+        xmlXPathExprCacheFreeEntry(entry);
+}
+
+/**
+ * Enable or disable the cache of compiled expressions. If enabled,
+ * #xmlXPathEval and the functions built on it keep the compiled
+ * form of the last `maxEntries` distinct expressions and reuse it
+ * when the same string is evaluated again.
+ *
+ * The cache is flushed when the context flags or dictionary change
+ * and when namespaces or functions are registered. It is bypassed
+ * if the context has an array of in-scope namespaces (`nsNr` > 0),
+ * since these are resolved at compile time for some expressions.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  the XPath context
+ * @param maxEntries  maximum number of cached expressions or 0 to
+ * disable the cache
+ * @returns 0 on success or -1 if a memory allocation failed.
+ */
+int
+xmlXPathContextSetExprCache(xmlXPathContext *ctxt, int maxEntries) {
+    xmlXPathExprCache *cache;
+
+    if (ctxt == NULL)
+        return(-1);
+
+    cache = ctxt->exprCache;
+
+    if (maxEntries <= 0) {
+        if (cache != NULL) {
+            xmlXPathExprCacheClear(ctxt);
+            xmlHashFree(cache->hash, NULL);
+            xmlFree(cache);
+            ctxt->exprCache = NULL;
+        }
+        return(0);
+    }
+
+    if (cache == NULL) {
+        cache = xmlMalloc(sizeof(*cache));
+        if (cache == NULL) {
+            xmlXPathErrMemory(ctxt);
+            return(-1);
+        }
+        memset(cache, 0, sizeof(*cache));
+        cache->hash = xmlHashCreate(0);
+        if (cache->hash == NULL) {
+            xmlFree(cache);
+            xmlXPathErrMemory(ctxt);
+            return(-1);
+        }
+        cache->flags = ctxt->flags;
+        cache->dict = ctxt->dict;
+        ctxt->exprCache = cache;
+    }
+
+    cache->maxEntries = maxEntries;
+    xmlXPathExprCacheTrim(cache, maxEntries);
+
+    return(0);
+}
+
+/**
+ * Enable or disable parallel evaluation of predicates. If enabled,
+ * predicates which don't depend on the position of the context node
+ * are evaluated with up to `nbThreads` threads for node-sets with at
+ * least `minNodes` members. The filtered node-set is the same as with
+ * sequential evaluation.
+ *
+ * The document must not be modified during evaluation, and extension
+ * functions, variable lookup and error handlers must be thread-safe.
+ * Namespace nodes, node-sets spanning multiple documents and contexts
+ * with a memory budget are always handled sequentially.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  the XPath context
+ * @param nbThreads  maximum number of threads or 0 to disable
+ * @param minNodes  minimum size of node-sets or 0 for the default
+ * @returns 0 on success or -1 if threads aren't supported.
+ */
+int
+xmlXPathContextSetParallel(xmlXPathContext *ctxt, int nbThreads,
+                           int minNodes) {
+    if (ctxt == NULL)
+        return(-1);
+
+    if (nbThreads <= 1) {
+        ctxt->parallelThreads = 0;
+        return(0);
+    }
+
+#ifdef XPATH_PARALLEL
+    ctxt->parallelThreads = nbThreads;
+    ctxt->parallelMinNodes = (minNodes > 0) ?
+                             minNodes : XPATH_PARALLEL_MIN_NODES;
+    return(0);
+#else
+    (void) minNodes;
+    return(-1);
+#endif
+}
+
 /************************************************************************
  *									*
  *			XPath object caching				*
@@ -1515,6 +2020,22 @@ xmlXPathNewCache(void)
 {
     xmlXPathContextCachePtr ret;
 
+    /*
+     * Start with the objects of contexts freed by this thread.
+     */
+    if (xmlXPathThreadCacheMax > 0) {
+        xmlXPathContextCachePtr *spare =
+            (xmlXPathContextCachePtr *) xmlGetLocalXPathCache();
+
+        if (*spare != NULL) {
+            ret = *spare;
+            *spare = NULL;
+            ret->maxNodeset = 100;
+            ret->maxMisc = 100;
+            return(ret);
+        }
+    }
+
     ret = (xmlXPathContextCachePtr) xmlMalloc(sizeof(xmlXPathContextCache));
     if (ret == NULL)
 	return(NULL);
@@ -1533,8 +2054,7 @@ xmlXPathCacheFreeObjectList(xmlXPathObjectPtr list)
         next = (void *) list->stringval;
 
 	if (list->nodesetval != NULL) {
-	    if (list->nodesetval->nodeTab != NULL)
-		xmlFree(list->nodesetval->nodeTab);
+	    xmlXPathNodeSetFreeTab(list->nodesetval);
 	    xmlFree(list->nodesetval);
 	}
 	xmlFree(list);
@@ -1556,16 +2076,110 @@ xmlXPathFreeCache(xmlXPathContextCachePtr cache)
 }
 
 /**
- * Creates/frees an object cache on the XPath context.
- * If activates XPath objects (xmlXPathObject) will be cached internally
- * to be reused.
- *
- * `options` must be set to 0 to enable XPath object caching.
- * Other values for `options` have currently no effect.
+ * Free the object cache of the current thread.
  *
- * `value` sets the maximum number of XPath objects to be cached per slot.
- * There are two slots for node-set and misc objects.
- * Use <0 for the default number (100).
+ * @param cache  the cache
+ */
+void
+xmlXPathFreeThreadCache(void *cache)
+{
+    xmlXPathFreeCache((xmlXPathContextCachePtr) cache);
+}
+
+/**
+ * Move objects from the list `from` to the list `to` until `to` has
+ * `max` objects.
+ */
+static void
+xmlXPathCacheMoveObjects(xmlXPathObjectPtr *to, int *numTo,
+                         xmlXPathObjectPtr *from, int *numFrom, int max)
+{
+    xmlXPathObjectPtr obj;
+
+    while ((*from != NULL) && (*numTo < max)) {
+        obj = *from;
+        *from = (void *) obj->stringval;
+        *numFrom -= 1;
+        obj->stringval = (void *) *to;
+        *to = obj;
+        *numTo += 1;
+    }
+}
+
+/**
+ * Free the object cache of a context. If enabled, the objects are
+ * kept for the next context created by the current thread.
+ *
+ * @param cache  the cache
+ */
+static void
+xmlXPathReleaseCache(xmlXPathContextCachePtr cache)
+{
+    xmlXPathContextCachePtr *spare;
+    int max = xmlXPathThreadCacheMax;
+
+    if (cache == NULL)
+	return;
+    if (max > 0) {
+        spare = (xmlXPathContextCachePtr *) xmlGetLocalXPathCache();
+        if (*spare == NULL)
+            *spare = xmlXPathNewCache();
+        if (*spare != NULL) {
+            xmlXPathCacheMoveObjects(&(*spare)->nodesetObjs,
+                                     &(*spare)->numNodeset,
+                                     &cache->nodesetObjs,
+                                     &cache->numNodeset, max);
+            xmlXPathCacheMoveObjects(&(*spare)->miscObjs,
+                                     &(*spare)->numMisc,
+                                     &cache->miscObjs,
+                                     &cache->numMisc, max);
+        }
+    }
+    xmlXPathFreeCache(cache);
+}
+
+/**
+ * Keep the cached XPath objects of freed contexts for the next
+ * context created by the same thread. This helps applications which
+ * create a short-lived context for each evaluation. Each thread keeps
+ * at most `maxObjects` node-set objects and `maxObjects` other
+ * objects. Node-sets keep the capacity of their arrays.
+ *
+ * This setting applies to all threads. It should be changed before
+ * threads using XPath are created. A value of 0 disables the thread
+ * caches, which is the default, and frees the cache of the current
+ * thread. The caches of other threads are freed when they exit.
+ *
+ * @since 2.16.0
+ *
+ * @param maxObjects  maximum number of objects per slot or 0
+ */
+void
+xmlXPathSetThreadCacheSize(int maxObjects)
+{
+    xmlXPathContextCachePtr *spare;
+
+    if (maxObjects < 0)
+        maxObjects = 0;
+    xmlXPathThreadCacheMax = maxObjects;
+    if (maxObjects == 0) {
+        spare = (xmlXPathContextCachePtr *) xmlGetLocalXPathCache();
+        xmlXPathFreeCache(*spare);
+        *spare = NULL;
+    }
+}
+
+/**
+ * Creates/frees an object cache on the XPath context.
+ * If activates XPath objects (xmlXPathObject) will be cached internally
+ * to be reused.
+ *
+ * `options` must be set to 0 to enable XPath object caching.
+ * Other values for `options` have currently no effect.
+ *
+ * `value` sets the maximum number of XPath objects to be cached per slot.
+ * There are two slots for node-set and misc objects.
+ * Use <0 for the default number (100).
  *
  * @param ctxt  the XPath context
  * @param active  enables/disables (creates/frees) the cache
@@ -1599,7 +2213,7 @@ xmlXPathContextSetCache(xmlXPathContext *ctxt,
 	    cache->maxMisc = value;
 	}
     } else if (ctxt->cache != NULL) {
-	xmlXPathFreeCache((xmlXPathContextCachePtr) ctxt->cache);
+	xmlXPathReleaseCache((xmlXPathContextCachePtr) ctxt->cache);
 	ctxt->cache = NULL;
     }
     return(0);
@@ -2202,23 +2816,203 @@ xmlXPathPopExternal (xmlXPathParserContext *ctxt) {
 #define NEXT ((*ctxt->cur) ?  ctxt->cur++: ctxt->cur)
 
 
-#ifndef DBL_DIG
-#define DBL_DIG 16
-#endif
-#ifndef DBL_EPSILON
-#define DBL_EPSILON 1E-9
-#endif
-
 #define UPPER_DOUBLE 1E9
 #define LOWER_DOUBLE 1E-5
-#define	LOWER_DOUBLE_EXP 5
 
-#define INTEGER_DIGITS DBL_DIG
-#define FRACTION_DIGITS (DBL_DIG + 1 + (LOWER_DOUBLE_EXP))
-#define EXPONENT_DIGITS (3 + 2)
+/*
+ * Powers of ten which are exact doubles
+ */
+static const double xmlXPathPow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Number of significant digits which are enough to round any decimal
+ * number correctly. Further digits only matter if they're non-zero.
+ */
+#define XPATH_MAX_DIGITS 768
+
+/**
+ * Convert a decimal number to the nearest double.
+ *
+ * If the digits fit into the 53 bits of a double and the power of ten
+ * is exact, a single multiplication or division is correctly rounded.
+ * Other numbers are converted with strtod, which doesn't depend on the
+ * locale without a decimal point.
+ *
+ * @param digits  the significant digits
+ * @param nbDigits  the number of digits, at most XPATH_MAX_DIGITS + 1
+ * @param exp10  the power of ten to multiply the digits with
+ * @returns the value
+ */
+static double
+xmlXPathDigitsToDouble(const char *digits, int nbDigits, int exp10)
+{
+    char buf[XPATH_MAX_DIGITS + 20];
+    unsigned long long mant = 0;
+    int i;
+
+    if ((nbDigits <= 19) && (exp10 >= -22) && (exp10 <= 22)) {
+        for (i = 0; i < nbDigits; i++)
+            mant = mant * 10 + (digits[i] - '0');
+        if (mant <= (1ULL << 53)) {
+            if (exp10 >= 0)
+                return((double) mant * xmlXPathPow10[exp10]);
+            return((double) mant / xmlXPathPow10[-exp10]);
+        }
+    }
+
+    memcpy(buf, digits, nbDigits);
+    snprintf(buf + nbDigits, sizeof(buf) - nbDigits, "e%d", exp10);
+    return(strtod(buf, NULL));
+}
+
+/**
+ * Parse an unsigned number
+ *
+ *     Number ::= Digits ('.' Digits?)? | '.' Digits
+ *
+ * optionally followed by an exponent ('e' | 'E') ('+' | '-')? Digits*.
+ * The result is the double nearest to the decimal value.
+ *
+ * @param str  the start of the number
+ * @param end  pointer to the end of the number
+ * @returns the value or NaN if `str` doesn't start with a number.
+ */
+static double
+xmlXPathParseNumber(const xmlChar *str, const xmlChar **end)
+{
+    char digits[XPATH_MAX_DIGITS + 1];
+    const xmlChar *cur = str;
+    int nbDigits = 0, exp10 = 0, exponent = 0;
+    int ok = 0, sticky = 0, isExponentNegative = 0;
+
+    *end = str;
+    while ((*cur >= '0') && (*cur <= '9')) {
+        ok = 1;
+        if (nbDigits < XPATH_MAX_DIGITS) {
+            if ((nbDigits > 0) || (*cur != '0'))
+                digits[nbDigits++] = *cur;
+        } else {
+            exp10 += 1;
+            if (*cur != '0')
+                sticky = 1;
+        }
+        cur++;
+    }
+    if (*cur == '.') {
+        cur++;
+        if (((*cur < '0') || (*cur > '9')) && (!ok))
+            return(xmlXPathNAN);
+        while ((*cur >= '0') && (*cur <= '9')) {
+            if (nbDigits < XPATH_MAX_DIGITS) {
+                if ((nbDigits > 0) || (*cur != '0'))
+                    digits[nbDigits++] = *cur;
+                exp10 -= 1;
+            } else if (*cur != '0') {
+                sticky = 1;
+            }
+            cur++;
+        }
+    } else if (!ok) {
+        return(xmlXPathNAN);
+    }
+    if ((*cur == 'e') || (*cur == 'E')) {
+        cur++;
+        if (*cur == '-') {
+            isExponentNegative = 1;
+            cur++;
+        } else if (*cur == '+') {
+            cur++;
+        }
+        while ((*cur >= '0') && (*cur <= '9')) {
+            if (exponent < 1000000)
+                exponent = exponent * 10 + (*cur - '0');
+            cur++;
+        }
+    }
+    *end = cur;
+
+    if (nbDigits == 0)
+        return(0.0);
+    /* Dropped digits only break ties */
+    if (sticky) {
+        digits[nbDigits++] = '1';
+        exp10 -= 1;
+    }
+    exp10 += isExponentNegative ? -exponent : exponent;
+    return(xmlXPathDigitsToDouble(digits, nbDigits, exp10));
+}
+
+/**
+ * Find the shortest decimal significand which converts back to
+ * `value`.
+ *
+ * @param value  a positive finite number
+ * @param digits  buffer of at least 20 bytes for the digits, which
+ *        are returned without trailing zeros
+ * @returns the power of ten of the first digit
+ */
+static int
+xmlXPathShortestDigits(double value, char *digits)
+{
+    char work[40];
+    int places, prec, nbDigits, exp10, i;
+
+    /*
+     * Numbers with few decimal places: find the smallest number of
+     * places which scales the value to an integer that converts back
+     * exactly. Below 10^15, the scaled value is too close to the
+     * integer for rounding to pick the wrong one.
+     */
+    for (places = 0; places <= 22; places++) {
+        double scaled = value * xmlXPathPow10[places];
+        unsigned long long n;
+
+        if (scaled >= 1e15)
+            break;
+        n = (unsigned long long) (scaled + 0.5);
+        if ((n != 0) && ((double) n / xmlXPathPow10[places] == value)) {
+            nbDigits = snprintf(work, sizeof(work), "%llu", n);
+            exp10 = nbDigits - 1 - places;
+            while (work[nbDigits - 1] == '0')
+                nbDigits--;
+            memcpy(digits, work, nbDigits);
+            digits[nbDigits] = 0;
+            return(exp10);
+        }
+    }
+
+    /*
+     * Otherwise, 15 digits are enough unless a longer representation
+     * is needed to convert back. The nearest representation with the
+     * given number of digits converts back if any does. Subnormal
+     * numbers can have fewer significant digits.
+     */
+    for (prec = (value < DBL_MIN) ? 1 : 15; prec <= 17; prec++) {
+        snprintf(work, sizeof(work), "%.*e", prec - 1, value);
+        nbDigits = 0;
+        for (i = 0; (work[i] != 0) && (work[i] != 'e'); i++) {
+            if ((work[i] >= '0') && (work[i] <= '9'))
+                digits[nbDigits++] = work[i];
+        }
+        exp10 = (work[i] == 'e') ? atoi(&work[i + 1]) : 0;
+        if ((prec == 17) ||
+            (xmlXPathDigitsToDouble(digits, nbDigits,
+                                    exp10 - nbDigits + 1) == value))
+            break;
+    }
+    while ((nbDigits > 1) && (digits[nbDigits - 1] == '0'))
+        nbDigits--;
+    digits[nbDigits] = 0;
+    return(exp10);
+}
 
 /**
- * Convert the number into a string representation.
+ * Convert the number into a string representation. Numbers are
+ * formatted with the shortest significand that converts back to the
+ * same number.
  *
  * @param number  number to format
  * @param buffer  output buffer
@@ -2266,77 +3060,61 @@ xmlXPathFormatNumber(double number, char buffer[], int buffersize)
 		*ptr = 0;
 	    }
 	} else {
-	    /*
-	      For the dimension of work,
-	          DBL_DIG is number of significant digits
-		  EXPONENT is only needed for "scientific notation"
-	          3 is sign, decimal point, and terminating zero
-		  LOWER_DOUBLE_EXP is max number of leading zeroes in fraction
-	      Note that this dimension is slightly (a few characters)
-	      larger than actually necessary.
-	    */
-	    char work[DBL_DIG + EXPONENT_DIGITS + 3 + LOWER_DOUBLE_EXP];
-	    int integer_place, fraction_place;
-	    char *ptr;
-	    char *after_fraction;
+            /*
+             * At most 17 digits, 22 leading or trailing zeros, sign,
+             * decimal point, exponent and terminating zero.
+             */
+	    char work[80];
+	    char digits[20];
 	    double absolute_value;
-	    int size;
+	    int exp10, nbDigits, i, size = 0;
 
 	    absolute_value = fabs(number);
+            exp10 = xmlXPathShortestDigits(absolute_value, digits);
+            nbDigits = strlen(digits);
 
-	    /*
-	     * First choose format - scientific or regular floating point.
-	     * In either case, result is in work, and after_fraction points
-	     * just past the fractional part.
-	    */
-	    if ( ((absolute_value > UPPER_DOUBLE) ||
-		  (absolute_value < LOWER_DOUBLE)) &&
-		 (absolute_value != 0.0) ) {
+            if (number < 0)
+                work[size++] = '-';
+	    if ((absolute_value > UPPER_DOUBLE) ||
+                (absolute_value < LOWER_DOUBLE)) {
 		/* Use scientific notation */
-		integer_place = DBL_DIG + EXPONENT_DIGITS + 1;
-		fraction_place = DBL_DIG - 1;
-		size = snprintf(work, sizeof(work),"%*.*e",
-			 integer_place, fraction_place, number);
-		while ((size > 0) && (work[size] != 'e')) size--;
-
-	    }
-	    else {
+                work[size++] = digits[0];
+                if (nbDigits > 1) {
+                    work[size++] = '.';
+                    memcpy(work + size, digits + 1, nbDigits - 1);
+                    size += nbDigits - 1;
+                }
+                size += snprintf(work + size, sizeof(work) - size, "e%c%02d",
+                                 exp10 < 0 ? '-' : '+',
+                                 exp10 < 0 ? -exp10 : exp10);
+	    } else if (exp10 < 0) {
 		/* Use regular notation */
-		if (absolute_value > 0.0) {
-		    integer_place = (int)log10(absolute_value);
-		    if (integer_place > 0)
-		        fraction_place = DBL_DIG - integer_place - 1;
-		    else
-		        fraction_place = DBL_DIG - integer_place;
-		} else {
-		    fraction_place = 1;
-		}
-		size = snprintf(work, sizeof(work), "%0.*f",
-				fraction_place, number);
-	    }
-
-	    /* Remove leading spaces sometimes inserted by snprintf */
-	    while (work[0] == ' ') {
-	        for (ptr = &work[0];(ptr[0] = ptr[1]);ptr++);
-		size--;
+                work[size++] = '0';
+                work[size++] = '.';
+                for (i = -1; i > exp10; i--)
+                    work[size++] = '0';
+                memcpy(work + size, digits, nbDigits);
+                size += nbDigits;
+            } else {
+                for (i = 0; (i <= exp10) || (i < nbDigits); i++) {
+                    if (i == exp10 + 1)
+                        work[size++] = '.';
+                    work[size++] = (i < nbDigits) ? digits[i] : '0';
+                }
 	    }
+            work[size++] = 0;
 
-	    /* Remove fractional trailing zeroes */
-	    after_fraction = work + size;
-	    ptr = after_fraction;
-	    while (*(--ptr) == '0')
-		;
-	    if (*ptr != '.')
-	        ptr++;
-	    while ((*ptr++ = *after_fraction++) != 0);
-
-	    /* Finally copy result back to caller */
-	    size = strlen(work) + 1;
-	    if (size > buffersize) {
-		work[buffersize - 1] = 0;
+	    /*
+             * Finally copy result back to caller, the terminator is
+             * written to the output so that it stays within both
+             * buffers when truncating.
+             */
+            if (buffersize <= 0)
+                break;
+	    if (size > buffersize)
 		size = buffersize;
-	    }
 	    memmove(buffer, work, size);
+            buffer[size - 1] = 0;
 	}
 	break;
     }
@@ -2356,6 +3134,8 @@ xmlXPathFormatNumber(double number, char buffer[], int buffersize)
  * field, the value stored is actually - the node number (starting at -1)
  * to be able to differentiate from line numbers.
  *
+ * Fails on frozen documents, see #xmlDocSetFrozen.
+ *
  * @param doc  an input document
  * @returns the number of elements found in the document or -1 in case
  *    of error.
@@ -2365,7 +3145,8 @@ xmlXPathOrderDocElems(xmlDoc *doc) {
     XML_INTPTR_T count = 0;
     xmlNodePtr cur;
 
-    if (doc == NULL)
+    /* Frozen documents must not be written to */
+    if ((doc == NULL) || (doc->properties & XML_DOC_FROZEN))
 	return(-1);
     cur = doc->children;
     while (cur != NULL) {
@@ -2543,6 +3324,130 @@ xmlXPathCmpNodes(xmlNode *node1, xmlNode *node2) {
     return(-1); /* assume there is no sibling list corruption */
 }
 
+/*
+ * Get the document order keys of the nodes in a set. Returns an array
+ * which must be freed or NULL if the document of the nodes has no
+ * name index or a node isn't numbered.
+ */
+static xmlXPathOrderKey *
+xmlXPathNodeSetGetKeys(xmlNodeSetPtr set) {
+    xmlXPathOrderKey *keys;
+    xmlNodePtr node;
+    int *order;
+    int i;
+
+    node = set->nodeTab[0];
+    if ((node->type == XML_NAMESPACE_DECL) || (node->doc == NULL) ||
+        (node->doc->nameIndex == NULL))
+        return(NULL);
+
+    order = xmlMalloc(set->nodeNr * sizeof(order[0]));
+    if (order == NULL)
+        return(NULL);
+    if (xmlDocIndexNodeOrder(set->nodeTab, set->nodeNr, order) < 0) {
+        xmlFree(order);
+        return(NULL);
+    }
+
+    keys = xmlMalloc(set->nodeNr * sizeof(keys[0]));
+    if (keys != NULL) {
+        for (i = 0; i < set->nodeNr; i++) {
+            keys[i].key = order[i];
+            keys[i].node = set->nodeTab[i];
+        }
+    }
+
+    xmlFree(order);
+    return(keys);
+}
+
+/*
+ * Sort a node set using the document order table of the name index.
+ * Returns 0 on success, -1 if the keys aren't available.
+ */
+static int
+xmlXPathNodeSetSortByKey(xmlNodeSetPtr set) {
+    xmlXPathOrderKey *keys;
+    int i;
+
+    keys = xmlXPathNodeSetGetKeys(set);
+    if (keys == NULL)
+        return(-1);
+
+    libxml_orderkey_tim_sort(keys, set->nodeNr);
+    for (i = 0; i < set->nodeNr; i++)
+        set->nodeTab[i] = keys[i].node;
+
+    xmlFree(keys);
+    return(0);
+}
+
+/*
+ * Merge two node-sets without duplicates using the document order
+ * table of the name index. The merged set is stored sorted in `set1`.
+ * Returns 0 on success, -1 if the sets are too small or the keys
+ * aren't available.
+ */
+static int
+xmlXPathNodeSetMergeByKey(xmlNodeSetPtr set1, xmlNodeSetPtr set2) {
+    xmlXPathOrderKey *keys1, *keys2;
+    xmlNodePtr *tab;
+    int i, j, nb, max;
+
+    if ((set1->nodeNr < XP_ORDER_KEYS_MIN) ||
+        (set2->nodeNr < XP_ORDER_KEYS_MIN) ||
+        (set1->nodeNr > XPATH_MAX_NODESET_LENGTH - set2->nodeNr))
+        return(-1);
+
+    keys1 = xmlXPathNodeSetGetKeys(set1);
+    if (keys1 == NULL)
+        return(-1);
+    keys2 = xmlXPathNodeSetGetKeys(set2);
+    if ((keys2 == NULL) ||
+        (set1->nodeTab[0]->doc != set2->nodeTab[0]->doc))
+        goto error;
+
+    max = set1->nodeNr + set2->nodeNr;
+    tab = xmlMalloc(max * sizeof(tab[0]));
+    if (tab == NULL)
+        goto error;
+
+    libxml_orderkey_tim_sort(keys1, set1->nodeNr);
+    libxml_orderkey_tim_sort(keys2, set2->nodeNr);
+
+    i = 0;
+    j = 0;
+    nb = 0;
+    while ((i < set1->nodeNr) && (j < set2->nodeNr)) {
+        if (keys1[i].key < keys2[j].key) {
+            tab[nb++] = keys1[i++].node;
+        } else if (keys1[i].key > keys2[j].key) {
+            tab[nb++] = keys2[j++].node;
+        } else {
+            tab[nb++] = keys1[i++].node;
+            j++;
+        }
+    }
+    while (i < set1->nodeNr)
+        tab[nb++] = keys1[i++].node;
+    while (j < set2->nodeNr)
+        tab[nb++] = keys2[j++].node;
+
+    xmlXPathNodeSetFreeTab(set1);
+    set1->nodeTab = tab;
+    set1->nodeNr = nb;
+    set1->nodeMax = max;
+
+    xmlFree(keys1);
+    xmlFree(keys2);
+    return(0);
+
+error:
+    xmlFree(keys1);
+    xmlFree(keys2);
+    return(-1);
+}
+
 /**
  * Sort the node set in document order
  *
@@ -2586,6 +3491,9 @@ xmlXPathNodeSetSort(xmlNodeSet *set) {
 	}
     }
 #else /* WITH_TIM_SORT */
+    if ((set->nodeNr >= XP_ORDER_KEYS_MIN) &&
+        (xmlXPathNodeSetSortByKey(set) == 0))
+        return;
     libxml_domnode_tim_sort(set->nodeTab, set->nodeNr);
 #endif /* WITH_TIM_SORT */
 }
@@ -2667,20 +3575,14 @@ xmlNodeSet *
 xmlXPathNodeSetCreate(xmlNode *val) {
     xmlNodeSetPtr ret;
 
-    ret = (xmlNodeSetPtr) xmlMalloc(sizeof(xmlNodeSet));
+    ret = (xmlNodeSetPtr) xmlMalloc(sizeof(xmlNodeSet) +
+                                    XP_NODESET_INLINE * sizeof(xmlNodePtr));
     if (ret == NULL)
 	return(NULL);
     memset(ret, 0 , sizeof(xmlNodeSet));
+    ret->nodeTab = XP_NODESET_INLINE_TAB(ret);
+    ret->nodeMax = XP_NODESET_INLINE;
     if (val != NULL) {
-        ret->nodeTab = (xmlNodePtr *) xmlMalloc(XML_NODESET_DEFAULT *
-					     sizeof(xmlNodePtr));
-	if (ret->nodeTab == NULL) {
-	    xmlFree(ret);
-	    return(NULL);
-	}
-	memset(ret->nodeTab, 0 ,
-	       XML_NODESET_DEFAULT * sizeof(xmlNodePtr));
-        ret->nodeMax = XML_NODESET_DEFAULT;
 	if (val->type == XML_NAMESPACE_DECL) {
 	    xmlNsPtr ns = (xmlNsPtr) val;
             xmlNodePtr nsNode = xmlXPathNodeSetDupNs((xmlNodePtr) ns->next, ns);
@@ -2736,13 +3638,23 @@ xmlXPathNodeSetGrow(xmlNodeSetPtr cur) {
     xmlNodePtr *temp;
     int newSize;
 
-    newSize = xmlGrowCapacity(cur->nodeMax, sizeof(temp[0]),
-                              XML_NODESET_DEFAULT, XPATH_MAX_NODESET_LENGTH);
-    if (newSize < 0)
-        return(-1);
-    temp = xmlRealloc(cur->nodeTab, newSize * sizeof(temp[0]));
-    if (temp == NULL)
-        return(-1);
+    if (cur->nodeTab == XP_NODESET_INLINE_TAB(cur)) {
+        /* Spill the inline nodes to the heap */
+        newSize = XML_NODESET_DEFAULT;
+        temp = xmlMalloc(newSize * sizeof(temp[0]));
+        if (temp == NULL)
+            return(-1);
+        memcpy(temp, cur->nodeTab, cur->nodeNr * sizeof(temp[0]));
+    } else {
+        newSize = xmlGrowCapacity(cur->nodeMax, sizeof(temp[0]),
+                                  XML_NODESET_DEFAULT,
+                                  XPATH_MAX_NODESET_LENGTH);
+        if (newSize < 0)
+            return(-1);
+        temp = xmlRealloc(cur->nodeTab, newSize * sizeof(temp[0]));
+        if (temp == NULL)
+            return(-1);
+    }
     cur->nodeMax = newSize;
     cur->nodeTab = temp;
 
@@ -2866,6 +3778,108 @@ xmlXPathNodeSetAddUnique(xmlNodeSet *cur, xmlNode *val) {
     return(0);
 }
 
+/*
+ * Open addressing set of the nodes in a node-set. Namespace nodes are
+ * keyed by their parent and prefix like in the quadratic duplicate
+ * checks.
+ */
+typedef struct {
+    xmlNodePtr *tab;
+    unsigned mask;
+} xmlXPathNodeHash;
+
+static unsigned
+xmlXPathNodeHashValue(xmlNodePtr node) {
+    size_t ptr;
+    unsigned hash;
+
+    if (node->type == XML_NAMESPACE_DECL) {
+        xmlNsPtr ns = (xmlNsPtr) node;
+        const xmlChar *prefix = ns->prefix;
+
+        ptr = (size_t) ns->next;
+        hash = 0;
+        if (prefix != NULL) {
+            while (*prefix != 0)
+                hash = hash * 31 + *prefix++;
+        }
+    } else {
+        ptr = (size_t) node;
+        hash = 0;
+    }
+
+    hash ^= (unsigned) (ptr >> 4) ^ (unsigned) (ptr >> 20);
+    return(hash * 0x9E3779B1u);
+}
+
+static int
+xmlXPathNodeHashEqual(xmlNodePtr n1, xmlNodePtr n2) {
+    if (n1 == n2)
+        return(1);
+    return((n1->type == XML_NAMESPACE_DECL) &&
+           (n2->type == XML_NAMESPACE_DECL) &&
+           (((xmlNsPtr) n1)->next == ((xmlNsPtr) n2)->next) &&
+           (xmlStrEqual(((xmlNsPtr) n1)->prefix, ((xmlNsPtr) n2)->prefix)));
+}
+
+/*
+ * Build the hash of the nodes in `set`. Returns 0 on success, -1 if
+ * the sets are too small or on memory errors. The caller falls back
+ * to comparing nodes in this case.
+ */
+static int
+xmlXPathNodeHashInit(xmlXPathNodeHash *hash, xmlNodeSetPtr set,
+                     int otherNr) {
+    unsigned size, i;
+    int j;
+
+    hash->tab = NULL;
+    hash->mask = 0;
+
+    if ((set->nodeNr < XP_HASH_MERGE_MIN) || (otherNr < XP_HASH_MERGE_MIN))
+        return(-1);
+
+    size = 64;
+    while (size / 2 < (unsigned) set->nodeNr)
+        size *= 2;
+    hash->tab = xmlMalloc(size * sizeof(hash->tab[0]));
+    if (hash->tab == NULL)
+        return(-1);
+    memset(hash->tab, 0, size * sizeof(hash->tab[0]));
+    hash->mask = size - 1;
+
+    for (j = 0; j < set->nodeNr; j++) {
+        xmlNodePtr node = set->nodeTab[j];
+
+        i = xmlXPathNodeHashValue(node) & hash->mask;
+        while (hash->tab[i] != NULL) {
+            if (xmlXPathNodeHashEqual(hash->tab[i], node))
+                break;
+            i = (i + 1) & hash->mask;
+        }
+        hash->tab[i] = node;
+    }
+
+    return(0);
+}
+
+/*
+ * Returns the node of the set equal to `node` or NULL.
+ */
+static xmlNodePtr
+xmlXPathNodeHashLookup(xmlXPathNodeHash *hash, xmlNodePtr node) {
+    unsigned i;
+
+    i = xmlXPathNodeHashValue(node) & hash->mask;
+    while (hash->tab[i] != NULL) {
+        if (xmlXPathNodeHashEqual(hash->tab[i], node))
+            return(hash->tab[i]);
+        i = (i + 1) & hash->mask;
+    }
+
+    return(NULL);
+}
+
 /**
  * Merges two nodesets, all nodes from `val2` are added to `val1`
  * if `val1` is NULL, a new set is created and copied from `val2`
@@ -2878,7 +3892,8 @@ xmlXPathNodeSetAddUnique(xmlNodeSet *cur, xmlNode *val) {
  */
 xmlNodeSet *
 xmlXPathNodeSetMerge(xmlNodeSet *val1, xmlNodeSet *val2) {
-    int i, j, initNr, skip;
+    xmlXPathNodeHash hash;
+    int i, j, initNr, skip, useHash;
     xmlNodePtr n1, n2;
 
     if (val1 == NULL) {
@@ -2889,8 +3904,12 @@ xmlXPathNodeSetMerge(xmlNodeSet *val1, xmlNodeSet *val2) {
     if (val2 == NULL)
         return(val1);
 
+    if (xmlXPathNodeSetMergeByKey(val1, val2) == 0)
+        return(val1);
+
     /* @@ with_ns to check whether namespace nodes should be looked at @@ */
     initNr = val1->nodeNr;
+    useHash = (xmlXPathNodeHashInit(&hash, val1, val2->nodeNr) == 0);
 
     for (i = 0;i < val2->nodeNr;i++) {
 	n2 = val2->nodeTab[i];
@@ -2898,22 +3917,26 @@ xmlXPathNodeSetMerge(xmlNodeSet *val1, xmlNodeSet *val2) {
 	 * check against duplicates
 	 */
 	skip = 0;
-	for (j = 0; j < initNr; j++) {
-	    n1 = val1->nodeTab[j];
-	    if (n1 == n2) {
-		skip = 1;
-		break;
-	    } else if ((n1->type == XML_NAMESPACE_DECL) &&
-		       (n2->type == XML_NAMESPACE_DECL)) {
-		if ((((xmlNsPtr) n1)->next == ((xmlNsPtr) n2)->next) &&
-		    (xmlStrEqual(((xmlNsPtr) n1)->prefix,
-			((xmlNsPtr) n2)->prefix)))
-		{
-		    skip = 1;
-		    break;
-		}
-	    }
-	}
+        if (useHash) {
+            skip = (xmlXPathNodeHashLookup(&hash, n2) != NULL);
+        } else {
+            for (j = 0; j < initNr; j++) {
+                n1 = val1->nodeTab[j];
+                if (n1 == n2) {
+                    skip = 1;
+                    break;
+                } else if ((n1->type == XML_NAMESPACE_DECL) &&
+                           (n2->type == XML_NAMESPACE_DECL)) {
+                    if ((((xmlNsPtr) n1)->next == ((xmlNsPtr) n2)->next) &&
+                        (xmlStrEqual(((xmlNsPtr) n1)->prefix,
+                            ((xmlNsPtr) n2)->prefix)))
+                    {
+                        skip = 1;
+                        break;
+                    }
+                }
+            }
+        }
 	if (skip)
 	    continue;
 
@@ -2935,9 +3958,11 @@ xmlXPathNodeSetMerge(xmlNodeSet *val1, xmlNodeSet *val2) {
 	    val1->nodeTab[val1->nodeNr++] = n2;
     }
 
+    xmlFree(hash.tab);
     return(val1);
 
 error:
+    xmlFree(hash.tab);
     xmlXPathFreeNodeSet(val1);
     return(NULL);
 }
@@ -2956,35 +3981,52 @@ error:
 static xmlNodeSetPtr
 xmlXPathNodeSetMergeAndClear(xmlNodeSetPtr set1, xmlNodeSetPtr set2)
 {
-    {
-	int i, j, initNbSet1;
-	xmlNodePtr n1, n2;
+    xmlXPathNodeHash hash;
+
+    if (xmlXPathNodeSetMergeByKey(set1, set2) == 0) {
+        set2->nodeNr = 0;
+        return(set1);
+    }
+
+    {
+	int i, j, initNbSet1, useHash;
+	xmlNodePtr n1, n2;
 
 	initNbSet1 = set1->nodeNr;
+        useHash = (xmlXPathNodeHashInit(&hash, set1, set2->nodeNr) == 0);
 	for (i = 0;i < set2->nodeNr;i++) {
 	    n2 = set2->nodeTab[i];
 	    /*
 	    * Skip duplicates.
 	    */
-	    for (j = 0; j < initNbSet1; j++) {
-		n1 = set1->nodeTab[j];
-		if (n1 == n2) {
-		    goto skip_node;
-		} else if ((n1->type == XML_NAMESPACE_DECL) &&
-		    (n2->type == XML_NAMESPACE_DECL))
-		{
-		    if ((((xmlNsPtr) n1)->next == ((xmlNsPtr) n2)->next) &&
-			(xmlStrEqual(((xmlNsPtr) n1)->prefix,
-			((xmlNsPtr) n2)->prefix)))
-		    {
-			/*
-			* Free the namespace node.
-			*/
-			xmlXPathNodeSetFreeNs((xmlNsPtr) n2);
-			goto skip_node;
-		    }
-		}
-	    }
+            if (useHash) {
+                n1 = xmlXPathNodeHashLookup(&hash, n2);
+                if (n1 != NULL) {
+                    if (n1 != n2)
+                        xmlXPathNodeSetFreeNs((xmlNsPtr) n2);
+                    goto skip_node;
+                }
+            } else {
+                for (j = 0; j < initNbSet1; j++) {
+                    n1 = set1->nodeTab[j];
+                    if (n1 == n2) {
+                        goto skip_node;
+                    } else if ((n1->type == XML_NAMESPACE_DECL) &&
+                        (n2->type == XML_NAMESPACE_DECL))
+                    {
+                        if ((((xmlNsPtr) n1)->next == ((xmlNsPtr) n2)->next) &&
+                            (xmlStrEqual(((xmlNsPtr) n1)->prefix,
+                            ((xmlNsPtr) n2)->prefix)))
+                        {
+                            /*
+                            * Free the namespace node.
+                            */
+                            xmlXPathNodeSetFreeNs((xmlNsPtr) n2);
+                            goto skip_node;
+                        }
+                    }
+                }
+            }
 	    /*
 	    * grow the nodeTab if needed
 	    */
@@ -2997,10 +4039,12 @@ skip_node:
             set2->nodeTab[i] = NULL;
 	}
     }
+    xmlFree(hash.tab);
     set2->nodeNr = 0;
     return(set1);
 
 error:
+    xmlFree(hash.tab);
     xmlXPathFreeNodeSet(set1);
     xmlXPathNodeSetClear(set2, 1);
     return(NULL);
@@ -3108,7 +4152,7 @@ xmlXPathFreeNodeSet(xmlNodeSet *obj) {
 	    if ((obj->nodeTab[i] != NULL) &&
 		(obj->nodeTab[i]->type == XML_NAMESPACE_DECL))
 		xmlXPathNodeSetFreeNs((xmlNsPtr) obj->nodeTab[i]);
-	xmlFree(obj->nodeTab);
+	xmlXPathNodeSetFreeTab(obj);
     }
     xmlFree(obj);
 }
@@ -3696,6 +4740,8 @@ xmlXPathRegisterFuncNS(xmlXPathContext *ctxt, const xmlChar *name,
     if (name == NULL)
 	return(-1);
 
+    xmlXPathExprCacheClear(ctxt);
+
     if (ctxt->funcHash == NULL)
 	ctxt->funcHash = xmlHashCreate(0);
     if (ctxt->funcHash == NULL) {
@@ -3727,10 +4773,34 @@ xmlXPathRegisterFuncLookup (xmlXPathContext *ctxt,
 			    void *funcCtxt) {
     if (ctxt == NULL)
 	return;
+    xmlXPathExprCacheClear(ctxt);
     ctxt->funcLookupFunc = f;
     ctxt->funcLookupData = funcCtxt;
 }
 
+/*
+ * Look up a function of the XPath 1.0 core library. These can't be
+ * overridden, so they're bound when an expression is compiled.
+ */
+static xmlXPathFunction
+xmlXPathStandardFunctionLookup(const xmlChar *name) {
+    int bucketIndex = xmlXPathSFComputeHash(name) % SF_HASH_SIZE;
+
+    while (xmlXPathSFHash[bucketIndex] != UCHAR_MAX) {
+        int funcIndex = xmlXPathSFHash[bucketIndex];
+
+        if (strcmp(xmlXPathStandardFunctions[funcIndex].name,
+                   (char *) name) == 0)
+            return(xmlXPathStandardFunctions[funcIndex].func);
+
+        bucketIndex += 1;
+        if (bucketIndex >= SF_HASH_SIZE)
+            bucketIndex = 0;
+    }
+
+    return(NULL);
+}
+
 /**
  * Search in the Function array of the context for the given
  * function.
@@ -3765,19 +4835,9 @@ xmlXPathFunctionLookupNS(xmlXPathContext *ctxt, const xmlChar *name,
 	return(NULL);
 
     if (ns_uri == NULL) {
-        int bucketIndex = xmlXPathSFComputeHash(name) % SF_HASH_SIZE;
-
-        while (xmlXPathSFHash[bucketIndex] != UCHAR_MAX) {
-            int funcIndex = xmlXPathSFHash[bucketIndex];
-
-            if (strcmp(xmlXPathStandardFunctions[funcIndex].name,
-                       (char *) name) == 0)
-                return(xmlXPathStandardFunctions[funcIndex].func);
-
-            bucketIndex += 1;
-            if (bucketIndex >= SF_HASH_SIZE)
-                bucketIndex = 0;
-        }
+        ret = xmlXPathStandardFunctionLookup(name);
+        if (ret != NULL)
+            return(ret);
     }
 
     if (ctxt->funcLookupFunc != NULL) {
@@ -3808,6 +4868,8 @@ xmlXPathRegisteredFuncsCleanup(xmlXPathContext *ctxt) {
     if (ctxt == NULL)
 	return;
 
+    xmlXPathExprCacheClear(ctxt);
+
     xmlHashFree(ctxt->funcHash, NULL);
     ctxt->funcHash = NULL;
 }
@@ -3968,6 +5030,8 @@ xmlXPathRegisterNs(xmlXPathContext *ctxt, const xmlChar *prefix,
     if (prefix[0] == 0)
 	return(-1);
 
+    xmlXPathExprCacheClear(ctxt);
+
     if (ctxt->nsHash == NULL)
 	ctxt->nsHash = xmlHashCreate(10);
     if (ctxt->nsHash == NULL) {
@@ -4034,6 +5098,8 @@ xmlXPathRegisteredNsCleanup(xmlXPathContext *ctxt) {
     if (ctxt == NULL)
 	return;
 
+    xmlXPathExprCacheClear(ctxt);
+
     xmlHashFree(ctxt->nsHash, xmlHashDefaultDeallocator);
     ctxt->nsHash = NULL;
 }
@@ -4530,18 +5596,19 @@ xmlXPathCastStringToNumber(const xmlChar * val) {
  */
 static double
 xmlXPathNodeToNumberInternal(xmlXPathParserContextPtr ctxt, xmlNodePtr node) {
-    xmlChar *strval;
+    const xmlChar *strval;
+    xmlChar *mem;
     double ret;
 
     if (node == NULL)
 	return(xmlXPathNAN);
-    strval = xmlXPathCastNodeToString(node);
+    strval = xmlNodeBorrowContent(node, &mem);
     if (strval == NULL) {
         xmlXPathPErrMemory(ctxt);
 	return(xmlXPathNAN);
     }
     ret = xmlXPathCastStringToNumber(strval);
-    xmlFree(strval);
+    xmlFree(mem);
 
     return(ret);
 }
@@ -4748,6 +5815,13 @@ xmlXPathNewContext(xmlDoc *doc) {
 	xmlXPathFreeContext(ret);
 	return(NULL);
     }
+#else
+    /* Contexts use the objects kept by the thread cache if enabled */
+    if ((xmlXPathThreadCacheMax > 0) &&
+        (xmlXPathContextSetCache(ret, 1, -1, 0) == -1)) {
+	xmlXPathFreeContext(ret);
+	return(NULL);
+    }
 #endif
 
     return(ret);
@@ -4763,5327 +5837,6671 @@ xmlXPathFreeContext(xmlXPathContext *ctxt) {
     if (ctxt == NULL) return;
 
     if (ctxt->cache != NULL)
-	xmlXPathFreeCache((xmlXPathContextCachePtr) ctxt->cache);
+	xmlXPathReleaseCache((xmlXPathContextCachePtr) ctxt->cache);
+    xmlXPathContextSetExprCache(ctxt, 0);
+    xmlXPathFreeKeys(ctxt);
     xmlXPathRegisteredNsCleanup(ctxt);
     xmlXPathRegisteredFuncsCleanup(ctxt);
     xmlXPathRegisteredVariablesCleanup(ctxt);
     xmlResetError(&ctxt->lastError);
+    xmlFree(ctxt->memBudget);
     xmlFree(ctxt);
 }
 
 /**
- * Register a callback function that will be called on errors and
- * warnings. If handler is NULL, the error handler will be deactivated.
+ * Limit the memory a single evaluation may hold. Allocations made
+ * while evaluating an expression are charged to the context. If the
+ * budget is exceeded, the evaluation fails with an
+ * XML_ERR_RESOURCE_LIMIT error.
+ *
+ * Memory is only accounted with an allocator which records block
+ * sizes like #xmlPoolMalloc or #xmlMemMalloc.
+ *
+ * @since 2.16.0
  *
- * @since 2.13.0
  * @param ctxt  the XPath context
- * @param handler  error handler
- * @param data  user data which will be passed to the handler
+ * @param maxMem  maximum number of bytes or 0 for no limit
+ * @returns 0 on success or -1 if budgets aren't supported by the
+ * allocator or a memory allocation failed.
  */
-void
-xmlXPathSetErrorHandler(xmlXPathContext *ctxt,
-                        xmlStructuredErrorFunc handler, void *data) {
+int
+xmlXPathContextSetMaxMemory(xmlXPathContext *ctxt, size_t maxMem) {
     if (ctxt == NULL)
-        return;
+        return(-1);
+    return(xmlMemBudgetSet(&ctxt->memBudget, maxMem));
+}
 
-    ctxt->error = handler;
-    ctxt->userData = data;
+/**
+ * @since 2.16.0
+ *
+ * @param ctxt  the XPath context
+ * @returns the number of bytes charged to the context's memory
+ * budget by the current or last evaluation.
+ */
+size_t
+xmlXPathContextGetMemoryUsed(xmlXPathContext *ctxt) {
+    if ((ctxt == NULL) || (ctxt->memBudget == NULL))
+        return(0);
+    return(ctxt->memBudget->used);
 }
 
-/************************************************************************
- *									*
- *		Routines to handle XPath parser contexts		*
- *									*
- ************************************************************************/
+/**
+ * Limit the wall-clock time of a single evaluation, measured with a
+ * monotonic clock from the start of the evaluation or iteration. The
+ * clock is checked periodically at the same points as the operation
+ * limit. Once the time is up, the evaluation fails with an
+ * XPATH_TIME_LIMIT_EXCEEDED error.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  the XPath context
+ * @param ms  maximum time in milliseconds or 0 for no limit
+ */
+void
+xmlXPathContextSetTimeLimit(xmlXPathContext *ctxt, unsigned long ms) {
+    if (ctxt == NULL)
+        return;
+    ctxt->timeLimit = ms;
+    xmlXPathStartDeadline(ctxt);
+}
 
 /**
- * Create a new xmlXPathParserContext
+ * Register a flag to cancel evaluations, typically from another
+ * thread. Evaluations with the context fail with an XPATH_CANCELLED
+ * error once the flag is non-zero. The flag is checked at the same
+ * points as the operation limit and must stay valid until it's
+ * unregistered or the context is freed.
+ *
+ * @since 2.16.0
  *
- * @param str  the XPath expression
  * @param ctxt  the XPath context
- * @returns the xmlXPathParserContext just allocated.
+ * @param flag  pointer to the flag or NULL to unregister
  */
-xmlXPathParserContext *
-xmlXPathNewParserContext(const xmlChar *str, xmlXPathContext *ctxt) {
-    xmlXPathParserContextPtr ret;
+void
+xmlXPathContextSetCancelFlag(xmlXPathContext *ctxt,
+                             const volatile int *flag) {
+    if (ctxt == NULL)
+        return;
+    ctxt->cancel = flag;
+}
 
-    ret = (xmlXPathParserContextPtr) xmlMalloc(sizeof(xmlXPathParserContext));
-    if (ret == NULL) {
-        xmlXPathErrMemory(ctxt);
-	return(NULL);
-    }
-    memset(ret, 0 , sizeof(xmlXPathParserContext));
-    ret->cur = ret->base = str;
-    ret->context = ctxt;
+/*
+ * Named key indexes, similar to xsl:key. A key selects nodes with
+ * the match expression, evaluated with the document node as context,
+ * and maps the string values of the use expression, evaluated for
+ * each matched node, to the matched nodes.
+ *
+ * The index of a key is built for a document on its first lookup and
+ * kept until #xmlXPathClearKeyIndexes is called. Node-sets in the
+ * index are in document order.
+ */
+typedef struct _xmlXPathKeyIndex xmlXPathKeyIndex;
+struct _xmlXPathKeyIndex {
+    xmlXPathKeyIndex *next;
+    xmlDocPtr doc;
+    /* maps string values to node-sets */
+    xmlHashTablePtr hash;
+};
 
-    ret->comp = xmlXPathNewCompExpr();
-    if (ret->comp == NULL) {
-        xmlXPathErrMemory(ctxt);
-	xmlFree(ret->valueTab);
-	xmlFree(ret);
-	return(NULL);
+typedef struct {
+    xmlXPathCompExprPtr match;
+    xmlXPathCompExprPtr use;
+    xmlXPathKeyIndex *indexes;
+} xmlXPathKey;
+
+static void
+xmlXPathFreeNodeSetEntry(void *set, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlXPathFreeNodeSet(set);
+}
+
+static void
+xmlXPathKeyFreeIndexes(xmlXPathKey *key) {
+    xmlXPathKeyIndex *index, *next;
+
+    for (index = key->indexes; index != NULL; index = next) {
+        next = index->next;
+        xmlHashFree(index->hash, xmlXPathFreeNodeSetEntry);
+        xmlFree(index);
     }
-    if ((ctxt != NULL) && (ctxt->dict != NULL)) {
-        ret->comp->dict = ctxt->dict;
-	xmlDictReference(ret->comp->dict);
+    key->indexes = NULL;
+}
+
+static void
+xmlXPathKeyClearScanner(void *payload, void *data ATTRIBUTE_UNUSED,
+                        const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlXPathKeyFreeIndexes(payload);
+}
+
+static void
+xmlXPathFreeKeyEntry(void *payload, const xmlChar *name ATTRIBUTE_UNUSED) {
+    xmlXPathKey *key = payload;
+
+    xmlXPathKeyFreeIndexes(key);
+    xmlXPathFreeCompExpr(key->match);
+    xmlXPathFreeCompExpr(key->use);
+    xmlFree(key);
+}
+
+static void
+xmlXPathFreeKeys(xmlXPathContextPtr ctxt) {
+    xmlHashFree(ctxt->keys, xmlXPathFreeKeyEntry);
+    ctxt->keys = NULL;
+}
+
+static int
+xmlXPathKeyIndexAdd(xmlHashTablePtr hash, const xmlChar *value,
+                    xmlNodePtr node) {
+    xmlNodeSetPtr set;
+
+    set = xmlHashLookup(hash, value);
+    if (set == NULL) {
+        set = xmlXPathNodeSetCreate(NULL);
+        if (set == NULL)
+            return(-1);
+        if (xmlHashAddEntry(hash, value, set) < 0) {
+            xmlXPathFreeNodeSet(set);
+            return(-1);
+        }
     }
 
-    return(ret);
+    /*
+     * Matched nodes are processed in document order, so a node can
+     * only be a duplicate of the last one.
+     */
+    if (node->type == XML_NAMESPACE_DECL)
+        return(xmlXPathNodeSetAdd(set, node));
+    if ((set->nodeNr > 0) && (set->nodeTab[set->nodeNr - 1] == node))
+        return(0);
+    return(xmlXPathNodeSetAddUnique(set, node));
 }
 
 /**
- * Create a new xmlXPathParserContext when processing a compiled expression
+ * Build the index of a key for a document.
  *
- * @param comp  the XPath compiled expression
  * @param ctxt  the XPath context
- * @returns the xmlXPathParserContext just allocated.
- */
-static xmlXPathParserContextPtr
-xmlXPathCompParserContext(xmlXPathCompExprPtr comp, xmlXPathContextPtr ctxt) {
-    xmlXPathParserContextPtr ret;
-
-    ret = (xmlXPathParserContextPtr) xmlMalloc(sizeof(xmlXPathParserContext));
-    if (ret == NULL) {
+ * @param key  the key
+ * @param doc  the document
+ * @returns the index or NULL if an error occurred.
+ */
+static xmlXPathKeyIndex *
+xmlXPathKeyBuildIndex(xmlXPathContextPtr ctxt, xmlXPathKey *key,
+                      xmlDocPtr doc) {
+    xmlXPathKeyIndex *index;
+    xmlXPathObjectPtr matches, values = NULL;
+    xmlNodePtr oldNode = ctxt->node;
+    xmlDocPtr oldDoc = ctxt->doc;
+    int oldSize = ctxt->contextSize;
+    int oldPos = ctxt->proximityPosition;
+    int i, j, ret = -1;
+
+    index = xmlMalloc(sizeof(*index));
+    if (index == NULL) {
         xmlXPathErrMemory(ctxt);
-	return(NULL);
+        return(NULL);
+    }
+    index->doc = doc;
+    index->hash = xmlHashCreate(0);
+    if (index->hash == NULL) {
+        xmlFree(index);
+        xmlXPathErrMemory(ctxt);
+        return(NULL);
     }
-    memset(ret, 0 , sizeof(xmlXPathParserContext));
 
-    /* Allocate the value stack */
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-    ret->valueMax = 1;
-#else
-    ret->valueMax = 10;
-#endif
-    ret->valueTab = xmlMalloc(ret->valueMax * sizeof(xmlXPathObjectPtr));
-    if (ret->valueTab == NULL) {
-	xmlFree(ret);
-	xmlXPathErrMemory(ctxt);
-	return(NULL);
+    ctxt->doc = doc;
+    ctxt->node = (xmlNodePtr) doc;
+    ctxt->contextSize = 1;
+    ctxt->proximityPosition = 1;
+
+    matches = xmlXPathCompiledEval(key->match, ctxt);
+    if ((matches == NULL) || (matches->type != XPATH_NODESET))
+        goto error;
+
+    if (matches->nodesetval != NULL) {
+        xmlNodeSetPtr set = matches->nodesetval;
+
+        xmlXPathNodeSetSort(set);
+
+        for (i = 0; i < set->nodeNr; i++) {
+            xmlNodePtr node = set->nodeTab[i];
+            xmlChar *str;
+
+            ctxt->node = node;
+            values = xmlXPathCompiledEval(key->use, ctxt);
+            if (values == NULL)
+                goto error;
+
+            if (values->type == XPATH_NODESET) {
+                if (values->nodesetval != NULL) {
+                    for (j = 0; j < values->nodesetval->nodeNr; j++) {
+                        str = xmlXPathCastNodeToString(
+                                values->nodesetval->nodeTab[j]);
+                        if ((str == NULL) ||
+                            (xmlXPathKeyIndexAdd(index->hash, str,
+                                                 node) < 0)) {
+                            xmlFree(str);
+                            xmlXPathErrMemory(ctxt);
+                            goto error;
+                        }
+                        xmlFree(str);
+                    }
+                }
+            } else {
+                str = xmlXPathCastToString(values);
+                if ((str == NULL) ||
+                    (xmlXPathKeyIndexAdd(index->hash, str, node) < 0)) {
+                    xmlFree(str);
+                    xmlXPathErrMemory(ctxt);
+                    goto error;
+                }
+                xmlFree(str);
+            }
+
+            xmlXPathFreeObject(values);
+            values = NULL;
+        }
     }
-    ret->valueNr = 0;
-    ret->value = NULL;
 
-    ret->context = ctxt;
-    ret->comp = comp;
+    index->next = key->indexes;
+    key->indexes = index;
+    ret = 0;
 
-    return(ret);
+error:
+    xmlXPathFreeObject(values);
+    xmlXPathFreeObject(matches);
+    if (ret < 0) {
+        xmlHashFree(index->hash, xmlXPathFreeNodeSetEntry);
+        xmlFree(index);
+        index = NULL;
+    }
+
+    ctxt->node = oldNode;
+    ctxt->doc = oldDoc;
+    ctxt->contextSize = oldSize;
+    ctxt->proximityPosition = oldPos;
+
+    return(index);
 }
 
 /**
- * Free up an xmlXPathParserContext
+ * Look up the nodes of a key with a value, building the index of
+ * the key for the document if needed.
  *
- * @param ctxt  the context to free
+ * @param ctxt  the XPath context
+ * @param doc  the document
+ * @param name  the key name
+ * @param value  the value
+ * @param set  pointer to the node-set in the index, NULL if no node
+ * matched
+ * @returns 0 on success, 1 if the key doesn't exist or -1 if an
+ * error occurred.
  */
-void
-xmlXPathFreeParserContext(xmlXPathParserContext *ctxt) {
-    int i;
+static int
+xmlXPathKeyGet(xmlXPathContextPtr ctxt, xmlDocPtr doc,
+               const xmlChar *name, const xmlChar *value,
+               xmlNodeSetPtr *set) {
+    xmlXPathKey *key;
+    xmlXPathKeyIndex *index;
 
-    if (ctxt == NULL)
-        return;
+    *set = NULL;
 
-    if (ctxt->valueTab != NULL) {
-        for (i = 0; i < ctxt->valueNr; i++) {
-            if (ctxt->context)
-                xmlXPathReleaseObject(ctxt->context, ctxt->valueTab[i]);
-            else
-                xmlXPathFreeObject(ctxt->valueTab[i]);
-        }
-        xmlFree(ctxt->valueTab);
+    key = xmlHashLookup(ctxt->keys, name);
+    if (key == NULL)
+        return(1);
+    if (doc == NULL)
+        return(0);
+
+    for (index = key->indexes; index != NULL; index = index->next) {
+        if (index->doc == doc)
+            break;
     }
-    if (ctxt->comp != NULL) {
-#ifdef XPATH_STREAMING
-	if (ctxt->comp->stream != NULL) {
-	    xmlFreePatternList(ctxt->comp->stream);
-	    ctxt->comp->stream = NULL;
-	}
-#endif
-	xmlXPathFreeCompExpr(ctxt->comp);
+    if (index == NULL) {
+        index = xmlXPathKeyBuildIndex(ctxt, key, doc);
+        if (index == NULL)
+            return(-1);
     }
-    xmlFree(ctxt);
-}
 
-/************************************************************************
- *									*
- *		The implicit core function library			*
- *									*
- ************************************************************************/
+    *set = xmlHashLookup(index->hash, value);
+    return(0);
+}
 
 /**
- * Function computing the beginning of the string value of the node,
- * used to speed up comparisons
+ * Implement the index-lookup() function registered with keys
+ *    node-set index-lookup(string, object)
+ * Returns the nodes of the key named by the first argument whose
+ * value matches the second argument in the document of the context
+ * node. If the second argument is a node-set, the result is the union
+ * of the lookups of the string values of its nodes.
  *
- * @param node  a node pointer
- * @returns an int usable as a hash
+ * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-static unsigned int
-xmlXPathNodeValHash(xmlNodePtr node) {
-    int len = 2;
-    const xmlChar * string = NULL;
-    xmlNodePtr tmp = NULL;
-    unsigned int ret = 0;
+static void
+xmlXPathIndexLookupFunction(xmlXPathParserContextPtr ctxt, int nargs) {
+    xmlXPathObjectPtr obj;
+    xmlNodeSetPtr ret = NULL, set;
+    xmlChar *name, *str;
+    int res = 0, i;
 
-    if (node == NULL)
-	return(0);
+    CHECK_ARITY(2);
+    obj = xmlXPathValuePop(ctxt);
+    name = xmlXPathPopString(ctxt);
+    if (name == NULL)
+        goto done;
+    ret = xmlXPathNodeSetCreate(NULL);
+    if (ret == NULL) {
+        xmlXPathPErrMemory(ctxt);
+        goto done;
+    }
 
-    if (node->type == XML_DOCUMENT_NODE) {
-	tmp = xmlDocGetRootElement((xmlDocPtr) node);
-	if (tmp == NULL)
-	    node = node->children;
-	else
-	    node = tmp;
-
-	if (node == NULL)
-	    return(0);
-    }
-
-    switch (node->type) {
-	case XML_COMMENT_NODE:
-	case XML_PI_NODE:
-	case XML_CDATA_SECTION_NODE:
-	case XML_TEXT_NODE:
-	    string = node->content;
-	    if (string == NULL)
-		return(0);
-	    if (string[0] == 0)
-		return(0);
-	    return(string[0] + (string[1] << 8));
-	case XML_NAMESPACE_DECL:
-	    string = ((xmlNsPtr)node)->href;
-	    if (string == NULL)
-		return(0);
-	    if (string[0] == 0)
-		return(0);
-	    return(string[0] + (string[1] << 8));
-	case XML_ATTRIBUTE_NODE:
-	    tmp = ((xmlAttrPtr) node)->children;
-	    break;
-	case XML_ELEMENT_NODE:
-	    tmp = node->children;
-	    break;
-	default:
-	    return(0);
+    if ((obj->type == XPATH_NODESET) || (obj->type == XPATH_XSLT_TREE)) {
+        if (obj->nodesetval != NULL) {
+            for (i = 0; i < obj->nodesetval->nodeNr; i++) {
+                str = xmlXPathCastNodeToString(obj->nodesetval->nodeTab[i]);
+                if (str == NULL) {
+                    xmlXPathPErrMemory(ctxt);
+                    goto done;
+                }
+                res = xmlXPathKeyGet(ctxt->context, ctxt->context->doc,
+                                     name, str, &set);
+                xmlFree(str);
+                if (res != 0)
+                    break;
+                if (set != NULL) {
+                    ret = xmlXPathNodeSetMerge(ret, set);
+                    if (ret == NULL) {
+                        xmlXPathPErrMemory(ctxt);
+                        goto done;
+                    }
+                }
+            }
+            if (obj->nodesetval->nodeNr > 1)
+                xmlXPathNodeSetSort(ret);
+        }
+    } else {
+        str = xmlXPathCastToString(obj);
+        if (str == NULL) {
+            xmlXPathPErrMemory(ctxt);
+            goto done;
+        }
+        res = xmlXPathKeyGet(ctxt->context, ctxt->context->doc,
+                             name, str, &set);
+        xmlFree(str);
+        if ((res == 0) && (set != NULL)) {
+            ret = xmlXPathNodeSetMerge(ret, set);
+            if (ret == NULL)
+                xmlXPathPErrMemory(ctxt);
+        }
     }
-    while (tmp != NULL) {
-	switch (tmp->type) {
-	    case XML_CDATA_SECTION_NODE:
-	    case XML_TEXT_NODE:
-		string = tmp->content;
-		break;
-	    default:
-                string = NULL;
-		break;
-	}
-	if ((string != NULL) && (string[0] != 0)) {
-	    if (len == 1) {
-		return(ret + (string[0] << 8));
-	    }
-	    if (string[1] == 0) {
-		len = 1;
-		ret = string[0];
-	    } else {
-		return(string[0] + (string[1] << 8));
-	    }
-	}
-	/*
-	 * Skip to next node
-	 */
-        if ((tmp->children != NULL) &&
-            (tmp->type != XML_DTD_NODE) &&
-            (tmp->type != XML_ENTITY_REF_NODE) &&
-            (tmp->children->type != XML_ENTITY_DECL)) {
-            tmp = tmp->children;
-            continue;
-	}
-	if (tmp == node)
-	    break;
 
-	if (tmp->next != NULL) {
-	    tmp = tmp->next;
-	    continue;
-	}
+    if (res > 0)
+        xmlXPathErr(ctxt, XPATH_INVALID_OPERAND);
+    else if (res < 0)
+        xmlXPathErr(ctxt, XPATH_EXPR_ERROR);
 
-	do {
-	    tmp = tmp->parent;
-	    if (tmp == NULL)
-		break;
-	    if (tmp == node) {
-		tmp = NULL;
-		break;
-	    }
-	    if (tmp->next != NULL) {
-		tmp = tmp->next;
-		break;
-	    }
-	} while (tmp != NULL);
+done:
+    xmlFree(name);
+    xmlXPathReleaseObject(ctxt->context, obj);
+    if (ctxt->error == XPATH_EXPRESSION_OK) {
+        xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, ret));
+    } else {
+        xmlXPathFreeNodeSet(ret);
     }
-    return(ret);
 }
 
 /**
- * Function computing the beginning of the string value of the node,
- * used to speed up comparisons
+ * Register a named key index, similar to `xsl:key`. The `match`
+ * expression is evaluated with the document node as context and
+ * selects the indexed nodes, for example `//item`. The `use`
+ * expression is evaluated for each of these nodes. Its string value,
+ * or the string values of its nodes if it returns a node-set, are
+ * the values under which the node can be found.
  *
- * @param string  a string
- * @returns an int usable as a hash
+ * Registering a key also registers the XPath function
+ * `index-lookup(name, value)` with the context, which returns the
+ * nodes of a key with a value in the document of the context node.
+ * The same lookup is available with #xmlXPathKeyLookup.
+ *
+ * The index of a key is built on the first lookup in a document and
+ * reused afterwards. It must be dropped with #xmlXPathClearKeyIndexes
+ * when an indexed document is modified or freed.
+ *
+ * @since 2.16.0
+ *
+ * @param ctxt  the XPath context
+ * @param name  the key name
+ * @param match  expression selecting the indexed nodes or NULL to
+ * unregister the key
+ * @param use  expression computing the values of a node
+ * @returns 0 on success or -1 if an expression failed to compile or
+ * a memory allocation failed.
  */
-static unsigned int
-xmlXPathStringHash(const xmlChar * string) {
-    if (string == NULL)
-	return(0);
-    if (string[0] == 0)
-	return(0);
-    return(string[0] + (string[1] << 8));
+int
+xmlXPathRegisterKey(xmlXPathContext *ctxt, const xmlChar *name,
+                    const xmlChar *match, const xmlChar *use) {
+    xmlXPathKey *key;
+
+    if ((ctxt == NULL) || (name == NULL))
+        return(-1);
+
+    if (match == NULL) {
+        if (ctxt->keys != NULL)
+            xmlHashRemoveEntry(ctxt->keys, name, xmlXPathFreeKeyEntry);
+        return(0);
+    }
+    if (use == NULL)
+        return(-1);
+
+    if (ctxt->keys == NULL) {
+        ctxt->keys = xmlHashCreate(0);
+        if (ctxt->keys == NULL) {
+            xmlXPathErrMemory(ctxt);
+            return(-1);
+        }
+    }
+
+    key = xmlMalloc(sizeof(*key));
+    if (key == NULL) {
+        xmlXPathErrMemory(ctxt);
+        return(-1);
+    }
+    memset(key, 0, sizeof(*key));
+    key->match = xmlXPathCtxtCompile(ctxt, match);
+    key->use = xmlXPathCtxtCompile(ctxt, use);
+    if ((key->match == NULL) || (key->use == NULL)) {
+        xmlXPathFreeKeyEntry(key, NULL);
+        return(-1);
+    }
+
+    if (xmlHashUpdateEntry(ctxt->keys, name, key,
+                           xmlXPathFreeKeyEntry) < 0) {
+        xmlXPathFreeKeyEntry(key, NULL);
+        xmlXPathErrMemory(ctxt);
+        return(-1);
+    }
+
+    if (xmlXPathFunctionLookup(ctxt, BAD_CAST "index-lookup") !=
+        xmlXPathIndexLookupFunction)
+        return(xmlXPathRegisterFunc(ctxt, BAD_CAST "index-lookup",
+                                    xmlXPathIndexLookupFunction));
+
+    return(0);
 }
 
 /**
- * Implement the compare operation between a nodeset and a number
- *     `ns` < `val`    (1, 1, ...
- *     `ns` <= `val`   (1, 0, ...
- *     `ns` > `val`    (0, 1, ...
- *     `ns` >= `val`   (0, 0, ...
+ * Look up the nodes of a key registered with #xmlXPathRegisterKey
+ * whose value is `value` in a document. The index of the key is
+ * built for the document if needed.
  *
- * If one object to be compared is a node-set and the other is a number,
- * then the comparison will be true if and only if there is a node in the
- * node-set such that the result of performing the comparison on the number
- * to be compared and on the result of converting the string-value of that
- * node to a number using the number function is true.
+ * @since 2.16.0
  *
- * @param ctxt  the XPath Parser context
- * @param inf  less than (1) or greater than (0)
- * @param strict  is the comparison strict
- * @param arg  the node set
- * @param f  the value
- * @returns 0 or 1 depending on the results of the test.
+ * @param ctxt  the XPath context
+ * @param doc  the document
+ * @param name  the key name
+ * @param value  the value to look up
+ * @returns a new node-set object with the nodes in document order
+ * or NULL if the key doesn't exist or an error occurred.
  */
-static int
-xmlXPathCompareNodeSetFloat(xmlXPathParserContextPtr ctxt, int inf, int strict,
-	                    xmlXPathObjectPtr arg, xmlXPathObjectPtr f) {
-    int i, ret = 0;
-    xmlNodeSetPtr ns;
-    xmlChar *str2;
+xmlXPathObject *
+xmlXPathKeyLookup(xmlXPathContext *ctxt, xmlDoc *doc,
+                  const xmlChar *name, const xmlChar *value) {
+    xmlXPathObjectPtr ret;
+    xmlNodeSetPtr set;
 
-    if ((f == NULL) || (arg == NULL) ||
-	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE))) {
-	xmlXPathReleaseObject(ctxt->context, arg);
-	xmlXPathReleaseObject(ctxt->context, f);
-        return(0);
-    }
-    ns = arg->nodesetval;
-    if (ns != NULL) {
-	for (i = 0;i < ns->nodeNr;i++) {
-	     str2 = xmlXPathCastNodeToString(ns->nodeTab[i]);
-	     if (str2 != NULL) {
-		 xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt, str2));
-		 xmlFree(str2);
-		 xmlXPathNumberFunction(ctxt, 1);
-		 xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, f));
-		 ret = xmlXPathCompareValues(ctxt, inf, strict);
-		 if (ret)
-		     break;
-	     } else {
-                 xmlXPathPErrMemory(ctxt);
-             }
-	}
+    if ((ctxt == NULL) || (doc == NULL) || (name == NULL) ||
+        (value == NULL))
+        return(NULL);
+
+    if (xmlXPathKeyGet(ctxt, doc, name, value, &set) != 0)
+        return(NULL);
+
+    ret = xmlXPathWrapNodeSet(xmlXPathNodeSetMerge(NULL, set));
+    if ((ret == NULL) || (ret->nodesetval == NULL)) {
+        xmlXPathFreeObject(ret);
+        xmlXPathErrMemory(ctxt);
+        return(NULL);
     }
-    xmlXPathReleaseObject(ctxt->context, arg);
-    xmlXPathReleaseObject(ctxt->context, f);
+
     return(ret);
 }
 
 /**
- * Implement the compare operation between a nodeset and a string
- *     `ns` < `val`    (1, 1, ...
- *     `ns` <= `val`   (1, 0, ...
- *     `ns` > `val`    (0, 1, ...
- *     `ns` >= `val`   (0, 0, ...
+ * Drop the indexes built for the keys of a context. They are rebuilt
+ * on the next lookup. This must be called after a document that was
+ * indexed is modified or freed.
  *
- * If one object to be compared is a node-set and the other is a string,
- * then the comparison will be true if and only if there is a node in
- * the node-set such that the result of performing the comparison on the
- * string-value of the node and the other string is true.
+ * @since 2.16.0
  *
- * @param ctxt  the XPath Parser context
- * @param inf  less than (1) or greater than (0)
- * @param strict  is the comparison strict
- * @param arg  the node set
- * @param s  the value
- * @returns 0 or 1 depending on the results of the test.
+ * @param ctxt  the XPath context
  */
-static int
-xmlXPathCompareNodeSetString(xmlXPathParserContextPtr ctxt, int inf, int strict,
-	                    xmlXPathObjectPtr arg, xmlXPathObjectPtr s) {
-    int i, ret = 0;
-    xmlNodeSetPtr ns;
-    xmlChar *str2;
+void
+xmlXPathClearKeyIndexes(xmlXPathContext *ctxt) {
+    if ((ctxt == NULL) || (ctxt->keys == NULL))
+        return;
 
-    if ((s == NULL) || (arg == NULL) ||
-	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE))) {
-	xmlXPathReleaseObject(ctxt->context, arg);
-	xmlXPathReleaseObject(ctxt->context, s);
-        return(0);
-    }
-    ns = arg->nodesetval;
-    if (ns != NULL) {
-	for (i = 0;i < ns->nodeNr;i++) {
-	     str2 = xmlXPathCastNodeToString(ns->nodeTab[i]);
-	     if (str2 != NULL) {
-		 xmlXPathValuePush(ctxt,
-			   xmlXPathCacheNewString(ctxt, str2));
-		 xmlFree(str2);
-		 xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, s));
-		 ret = xmlXPathCompareValues(ctxt, inf, strict);
-		 if (ret)
-		     break;
-	     } else {
-                 xmlXPathPErrMemory(ctxt);
-             }
-	}
-    }
-    xmlXPathReleaseObject(ctxt->context, arg);
-    xmlXPathReleaseObject(ctxt->context, s);
-    return(ret);
+    xmlHashScan(ctxt->keys, xmlXPathKeyClearScanner, NULL);
 }
 
 /**
- * Implement the compare operation on nodesets:
+ * Register a callback function that will be called on errors and
+ * warnings. If handler is NULL, the error handler will be deactivated.
  *
- * If both objects to be compared are node-sets, then the comparison
- * will be true if and only if there is a node in the first node-set
- * and a node in the second node-set such that the result of performing
- * the comparison on the string-values of the two nodes is true.
- * ....
- * When neither object to be compared is a node-set and the operator
- * is <=, <, >= or >, then the objects are compared by converting both
- * objects to numbers and comparing the numbers according to IEEE 754.
- * ....
- * The number function converts its argument to a number as follows:
- *  - a string that consists of optional whitespace followed by an
- *    optional minus sign followed by a Number followed by whitespace
- *    is converted to the IEEE 754 number that is nearest (according
- *    to the IEEE 754 round-to-nearest rule) to the mathematical value
- *    represented by the string; any other string is converted to NaN
- *
- * Conclusion all nodes need to be converted first to their string value
- * and then the comparison must be done when possible
- *
- * @param ctxt  XPath parser context
- * @param inf  less than (1) or greater than (0)
- * @param strict  is the comparison strict
- * @param arg1  the first node set object
- * @param arg2  the second node set object
+ * @since 2.13.0
+ * @param ctxt  the XPath context
+ * @param handler  error handler
+ * @param data  user data which will be passed to the handler
  */
-static int
-xmlXPathCompareNodeSets(xmlXPathParserContextPtr ctxt, int inf, int strict,
-	                xmlXPathObjectPtr arg1, xmlXPathObjectPtr arg2) {
-    int i, j, init = 0;
-    double val1;
-    double *values2;
-    int ret = 0;
-    xmlNodeSetPtr ns1;
-    xmlNodeSetPtr ns2;
+void
+xmlXPathSetErrorHandler(xmlXPathContext *ctxt,
+                        xmlStructuredErrorFunc handler, void *data) {
+    if (ctxt == NULL)
+        return;
 
-    if ((arg1 == NULL) ||
-	((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE))) {
-	xmlXPathFreeObject(arg2);
-        return(0);
-    }
-    if ((arg2 == NULL) ||
-	((arg2->type != XPATH_NODESET) && (arg2->type != XPATH_XSLT_TREE))) {
-	xmlXPathFreeObject(arg1);
-	xmlXPathFreeObject(arg2);
-        return(0);
-    }
+    ctxt->error = handler;
+    ctxt->userData = data;
+}
 
-    ns1 = arg1->nodesetval;
-    ns2 = arg2->nodesetval;
+/************************************************************************
+ *									*
+ *		Routines to handle XPath parser contexts		*
+ *									*
+ ************************************************************************/
 
-    if ((ns1 == NULL) || (ns1->nodeNr <= 0)) {
-	xmlXPathFreeObject(arg1);
-	xmlXPathFreeObject(arg2);
-	return(0);
-    }
-    if ((ns2 == NULL) || (ns2->nodeNr <= 0)) {
-	xmlXPathFreeObject(arg1);
-	xmlXPathFreeObject(arg2);
-	return(0);
+/**
+ * Create a new xmlXPathParserContext
+ *
+ * @param str  the XPath expression
+ * @param ctxt  the XPath context
+ * @returns the xmlXPathParserContext just allocated.
+ */
+xmlXPathParserContext *
+xmlXPathNewParserContext(const xmlChar *str, xmlXPathContext *ctxt) {
+    xmlXPathParserContextPtr ret;
+
+    ret = (xmlXPathParserContextPtr) xmlMalloc(sizeof(xmlXPathParserContext));
+    if (ret == NULL) {
+        xmlXPathErrMemory(ctxt);
+	return(NULL);
     }
+    memset(ret, 0 , sizeof(xmlXPathParserContext));
+    ret->cur = ret->base = str;
+    ret->context = ctxt;
 
-    values2 = (double *) xmlMalloc(ns2->nodeNr * sizeof(double));
-    if (values2 == NULL) {
-        xmlXPathPErrMemory(ctxt);
-	xmlXPathFreeObject(arg1);
-	xmlXPathFreeObject(arg2);
-	return(0);
+    ret->comp = xmlXPathNewCompExpr();
+    if (ret->comp == NULL) {
+        xmlXPathErrMemory(ctxt);
+	xmlFree(ret->valueTab);
+	xmlFree(ret);
+	return(NULL);
     }
-    for (i = 0;i < ns1->nodeNr;i++) {
-	val1 = xmlXPathNodeToNumberInternal(ctxt, ns1->nodeTab[i]);
-	if (xmlXPathIsNaN(val1))
-	    continue;
-	for (j = 0;j < ns2->nodeNr;j++) {
-	    if (init == 0) {
-		values2[j] = xmlXPathNodeToNumberInternal(ctxt,
-                                                          ns2->nodeTab[j]);
-	    }
-	    if (xmlXPathIsNaN(values2[j]))
-		continue;
-	    if (inf && strict)
-		ret = (val1 < values2[j]);
-	    else if (inf && !strict)
-		ret = (val1 <= values2[j]);
-	    else if (!inf && strict)
-		ret = (val1 > values2[j]);
-	    else if (!inf && !strict)
-		ret = (val1 >= values2[j]);
-	    if (ret)
-		break;
-	}
-	if (ret)
-	    break;
-	init = 1;
+    if ((ctxt != NULL) && (ctxt->dict != NULL)) {
+        ret->comp->dict = ctxt->dict;
+	xmlDictReference(ret->comp->dict);
     }
-    xmlFree(values2);
-    xmlXPathFreeObject(arg1);
-    xmlXPathFreeObject(arg2);
+
     return(ret);
 }
 
 /**
- * Implement the compare operation between a nodeset and a value
- *     `ns` < `val`    (1, 1, ...
- *     `ns` <= `val`   (1, 0, ...
- *     `ns` > `val`    (0, 1, ...
- *     `ns` >= `val`   (0, 0, ...
- *
- * If one object to be compared is a node-set and the other is a boolean,
- * then the comparison will be true if and only if the result of performing
- * the comparison on the boolean and on the result of converting
- * the node-set to a boolean using the boolean function is true.
+ * Create a new xmlXPathParserContext when processing a compiled expression
  *
- * @param ctxt  the XPath Parser context
- * @param inf  less than (1) or greater than (0)
- * @param strict  is the comparison strict
- * @param arg  the node set
- * @param val  the value
- * @returns 0 or 1 depending on the results of the test.
+ * @param comp  the XPath compiled expression
+ * @param ctxt  the XPath context
+ * @returns the xmlXPathParserContext just allocated.
  */
-static int
-xmlXPathCompareNodeSetValue(xmlXPathParserContextPtr ctxt, int inf, int strict,
-	                    xmlXPathObjectPtr arg, xmlXPathObjectPtr val) {
-    if ((val == NULL) || (arg == NULL) ||
-	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE)))
-        return(0);
+static xmlXPathParserContextPtr
+xmlXPathCompParserContext(xmlXPathCompExprPtr comp, xmlXPathContextPtr ctxt) {
+    xmlXPathParserContextPtr ret;
 
-    switch(val->type) {
-        case XPATH_NUMBER:
-	    return(xmlXPathCompareNodeSetFloat(ctxt, inf, strict, arg, val));
-        case XPATH_NODESET:
-        case XPATH_XSLT_TREE:
-	    return(xmlXPathCompareNodeSets(ctxt, inf, strict, arg, val));
-        case XPATH_STRING:
-	    return(xmlXPathCompareNodeSetString(ctxt, inf, strict, arg, val));
-        case XPATH_BOOLEAN:
-	    xmlXPathValuePush(ctxt, arg);
-	    xmlXPathBooleanFunction(ctxt, 1);
-	    xmlXPathValuePush(ctxt, val);
-	    return(xmlXPathCompareValues(ctxt, inf, strict));
-	default:
-            xmlXPathReleaseObject(ctxt->context, arg);
-            xmlXPathReleaseObject(ctxt->context, val);
-            XP_ERROR0(XPATH_INVALID_TYPE);
+    ret = (xmlXPathParserContextPtr) xmlMalloc(sizeof(xmlXPathParserContext));
+    if (ret == NULL) {
+        xmlXPathErrMemory(ctxt);
+	return(NULL);
     }
-    return(0);
+    memset(ret, 0 , sizeof(xmlXPathParserContext));
+
+    /* Allocate the value stack */
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+    ret->valueMax = 1;
+#else
+    ret->valueMax = 10;
+#endif
+    ret->valueTab = xmlMalloc(ret->valueMax * sizeof(xmlXPathObjectPtr));
+    if (ret->valueTab == NULL) {
+	xmlFree(ret);
+	xmlXPathErrMemory(ctxt);
+	return(NULL);
+    }
+    ret->valueNr = 0;
+    ret->value = NULL;
+
+    ret->context = ctxt;
+    ret->comp = comp;
+
+    return(ret);
 }
 
-/**
- * Implement the equal operation on XPath objects content: `arg1` == `arg2`
- * If one object to be compared is a node-set and the other is a string,
- * then the comparison will be true if and only if there is a node in
- * the node-set such that the result of performing the comparison on the
- * string-value of the node and the other string is true.
- *
- * @param ctxt  XPath parser context
- * @param arg  the nodeset object argument
- * @param str  the string to compare to.
- * @param neq  flag to show whether for '=' (0) or '!=' (1)
- * @returns 0 or 1 depending on the results of the test.
+/*
+ * Values of the context independent subexpressions of a compiled
+ * expression, see xmlXPathCompOpEvalInvariant. The values only depend
+ * on the document of the context, so they are stored with it.
  */
-static int
-xmlXPathEqualNodeSetString(xmlXPathParserContextPtr ctxt,
-                           xmlXPathObjectPtr arg, const xmlChar * str, int neq)
-{
+typedef struct {
+    xmlXPathObjectPtr value;
+    xmlDocPtr doc;
+} xmlXPathInvariantValue;
+
+typedef struct {
+    int nb;
+    xmlXPathInvariantValue *tab;
+} xmlXPathInvariants;
+
+static void
+xmlXPathFreeInvariants(xmlXPathInvariants *inv) {
     int i;
-    xmlNodeSetPtr ns;
-    xmlChar *str2;
-    unsigned int hash;
 
-    if ((str == NULL) || (arg == NULL) ||
-        ((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE)))
-        return (0);
-    ns = arg->nodesetval;
-    /*
-     * A NULL nodeset compared with a string is always false
-     * (since there is no node equal, and no node not equal)
-     */
-    if ((ns == NULL) || (ns->nodeNr <= 0) )
-        return (0);
-    hash = xmlXPathStringHash(str);
-    for (i = 0; i < ns->nodeNr; i++) {
-        if (xmlXPathNodeValHash(ns->nodeTab[i]) == hash) {
-            str2 = xmlNodeGetContent(ns->nodeTab[i]);
-            if (str2 == NULL) {
-                xmlXPathPErrMemory(ctxt);
-                return(0);
-            }
-            if (xmlStrEqual(str, str2)) {
-                xmlFree(str2);
-		if (neq)
-		    continue;
-                return (1);
-            } else if (neq) {
-		xmlFree(str2);
-		return (1);
-	    }
-            xmlFree(str2);
-        } else if (neq)
-	    return (1);
-    }
-    return (0);
+    if (inv == NULL)
+        return;
+    for (i = 0; i < inv->nb; i++)
+        xmlXPathFreeObject(inv->tab[i].value);
+    xmlFree(inv);
 }
 
 /**
- * Implement the equal operation on XPath objects content: `arg1` == `arg2`
- * If one object to be compared is a node-set and the other is a number,
- * then the comparison will be true if and only if there is a node in
- * the node-set such that the result of performing the comparison on the
- * number to be compared and on the result of converting the string-value
- * of that node to a number using the number function is true.
+ * Free up an xmlXPathParserContext
  *
- * @param ctxt  XPath parser context
- * @param arg  the nodeset object argument
- * @param f  the float to compare to
- * @param neq  flag to show whether to compare '=' (0) or '!=' (1)
- * @returns 0 or 1 depending on the results of the test.
+ * @param ctxt  the context to free
  */
-static int
-xmlXPathEqualNodeSetFloat(xmlXPathParserContextPtr ctxt,
-    xmlXPathObjectPtr arg, double f, int neq) {
-  int i, ret=0;
-  xmlNodeSetPtr ns;
-  xmlChar *str2;
-  xmlXPathObjectPtr val;
-  double v;
+void
+xmlXPathFreeParserContext(xmlXPathParserContext *ctxt) {
+    int i;
 
-    if ((arg == NULL) ||
-	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE)))
-        return(0);
+    if (ctxt == NULL)
+        return;
 
-    ns = arg->nodesetval;
-    if (ns != NULL) {
-	for (i=0;i<ns->nodeNr;i++) {
-	    str2 = xmlXPathCastNodeToString(ns->nodeTab[i]);
-	    if (str2 != NULL) {
-		xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt, str2));
-		xmlFree(str2);
-		xmlXPathNumberFunction(ctxt, 1);
-                CHECK_ERROR0;
-		val = xmlXPathValuePop(ctxt);
-		v = val->floatval;
-		xmlXPathReleaseObject(ctxt->context, val);
-		if (!xmlXPathIsNaN(v)) {
-		    if ((!neq) && (v==f)) {
-			ret = 1;
-			break;
-		    } else if ((neq) && (v!=f)) {
-			ret = 1;
-			break;
-		    }
-		} else {	/* NaN is unequal to any value */
-		    if (neq)
-			ret = 1;
-		}
-	    } else {
-                xmlXPathPErrMemory(ctxt);
-            }
+    xmlXPathFreeInvariants(ctxt->invariants);
+    xmlFree(ctxt->profile);
+
+    if (ctxt->valueTab != NULL) {
+        for (i = 0; i < ctxt->valueNr; i++) {
+            if (ctxt->context)
+                xmlXPathReleaseObject(ctxt->context, ctxt->valueTab[i]);
+            else
+                xmlXPathFreeObject(ctxt->valueTab[i]);
+        }
+        xmlFree(ctxt->valueTab);
+    }
+    if (ctxt->comp != NULL) {
+#ifdef XPATH_STREAMING
+	if (ctxt->comp->stream != NULL) {
+	    xmlFreePatternList(ctxt->comp->stream);
+	    ctxt->comp->stream = NULL;
 	}
+#endif
+	xmlXPathFreeCompExpr(ctxt->comp);
     }
-
-    return(ret);
+    xmlFree(ctxt);
 }
 
+/************************************************************************
+ *									*
+ *		The implicit core function library			*
+ *									*
+ ************************************************************************/
 
 /**
- * Implement the equal / not equal operation on XPath nodesets:
- * `arg1` == `arg2`  or  `arg1` != `arg2`
- * If both objects to be compared are node-sets, then the comparison
- * will be true if and only if there is a node in the first node-set and
- * a node in the second node-set such that the result of performing the
- * comparison on the string-values of the two nodes is true.
- *
- * (needless to say, this is a costly operation)
+ * Function computing the beginning of the string value of the node,
+ * used to speed up comparisons
  *
- * @param ctxt  XPath parser context
- * @param arg1  first nodeset object argument
- * @param arg2  second nodeset object argument
- * @param neq  flag to show whether to test '=' (0) or '!=' (1)
- * @returns 0 or 1 depending on the results of the test.
+ * @param node  a node pointer
+ * @returns an int usable as a hash
  */
-static int
-xmlXPathEqualNodeSets(xmlXPathParserContextPtr ctxt, xmlXPathObjectPtr arg1,
-                      xmlXPathObjectPtr arg2, int neq) {
-    int i, j;
-    unsigned int *hashs1;
-    unsigned int *hashs2;
-    xmlChar **values1;
-    xmlChar **values2;
-    int ret = 0;
-    xmlNodeSetPtr ns1;
-    xmlNodeSetPtr ns2;
-
-    if ((arg1 == NULL) ||
-	((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE)))
-        return(0);
-    if ((arg2 == NULL) ||
-	((arg2->type != XPATH_NODESET) && (arg2->type != XPATH_XSLT_TREE)))
-        return(0);
-
-    ns1 = arg1->nodesetval;
-    ns2 = arg2->nodesetval;
+static unsigned int
+xmlXPathNodeValHash(xmlNodePtr node) {
+    int len = 2;
+    const xmlChar * string = NULL;
+    xmlNodePtr tmp = NULL;
+    unsigned int ret = 0;
 
-    if ((ns1 == NULL) || (ns1->nodeNr <= 0))
-	return(0);
-    if ((ns2 == NULL) || (ns2->nodeNr <= 0))
+    if (node == NULL)
 	return(0);
 
-    /*
-     * for equal, check if there is a node pertaining to both sets
-     */
-    if (neq == 0)
-	for (i = 0;i < ns1->nodeNr;i++)
-	    for (j = 0;j < ns2->nodeNr;j++)
-		if (ns1->nodeTab[i] == ns2->nodeTab[j])
-		    return(1);
+    if (node->type == XML_DOCUMENT_NODE) {
+	tmp = xmlDocGetRootElement((xmlDocPtr) node);
+	if (tmp == NULL)
+	    node = node->children;
+	else
+	    node = tmp;
 
-    values1 = (xmlChar **) xmlMalloc(ns1->nodeNr * sizeof(xmlChar *));
-    if (values1 == NULL) {
-        xmlXPathPErrMemory(ctxt);
-	return(0);
-    }
-    hashs1 = (unsigned int *) xmlMalloc(ns1->nodeNr * sizeof(unsigned int));
-    if (hashs1 == NULL) {
-        xmlXPathPErrMemory(ctxt);
-	xmlFree(values1);
-	return(0);
-    }
-    memset(values1, 0, ns1->nodeNr * sizeof(xmlChar *));
-    values2 = (xmlChar **) xmlMalloc(ns2->nodeNr * sizeof(xmlChar *));
-    if (values2 == NULL) {
-        xmlXPathPErrMemory(ctxt);
-	xmlFree(hashs1);
-	xmlFree(values1);
-	return(0);
+	if (node == NULL)
+	    return(0);
     }
-    hashs2 = (unsigned int *) xmlMalloc(ns2->nodeNr * sizeof(unsigned int));
-    if (hashs2 == NULL) {
-        xmlXPathPErrMemory(ctxt);
-	xmlFree(hashs1);
-	xmlFree(values1);
-	xmlFree(values2);
-	return(0);
+
+    switch (node->type) {
+	case XML_COMMENT_NODE:
+	case XML_PI_NODE:
+	case XML_CDATA_SECTION_NODE:
+	case XML_TEXT_NODE:
+	    string = node->content;
+	    if (string == NULL)
+		return(0);
+	    if (string[0] == 0)
+		return(0);
+	    return(string[0] + (string[1] << 8));
+	case XML_NAMESPACE_DECL:
+	    string = ((xmlNsPtr)node)->href;
+	    if (string == NULL)
+		return(0);
+	    if (string[0] == 0)
+		return(0);
+	    return(string[0] + (string[1] << 8));
+	case XML_ATTRIBUTE_NODE:
+	    tmp = ((xmlAttrPtr) node)->children;
+	    break;
+	case XML_ELEMENT_NODE:
+	    tmp = node->children;
+	    break;
+	default:
+	    return(0);
     }
-    memset(values2, 0, ns2->nodeNr * sizeof(xmlChar *));
-    for (i = 0;i < ns1->nodeNr;i++) {
-	hashs1[i] = xmlXPathNodeValHash(ns1->nodeTab[i]);
-	for (j = 0;j < ns2->nodeNr;j++) {
-	    if (i == 0)
-		hashs2[j] = xmlXPathNodeValHash(ns2->nodeTab[j]);
-	    if (hashs1[i] != hashs2[j]) {
-		if (neq) {
-		    ret = 1;
-		    break;
-		}
+    while (tmp != NULL) {
+	switch (tmp->type) {
+	    case XML_CDATA_SECTION_NODE:
+	    case XML_TEXT_NODE:
+		string = tmp->content;
+		break;
+	    default:
+                string = NULL;
+		break;
+	}
+	if ((string != NULL) && (string[0] != 0)) {
+	    if (len == 1) {
+		return(ret + (string[0] << 8));
 	    }
-	    else {
-		if (values1[i] == NULL) {
-		    values1[i] = xmlNodeGetContent(ns1->nodeTab[i]);
-                    if (values1[i] == NULL)
-                        xmlXPathPErrMemory(ctxt);
-                }
-		if (values2[j] == NULL) {
-		    values2[j] = xmlNodeGetContent(ns2->nodeTab[j]);
-                    if (values2[j] == NULL)
-                        xmlXPathPErrMemory(ctxt);
-                }
-		ret = xmlStrEqual(values1[i], values2[j]) ^ neq;
-		if (ret)
-		    break;
+	    if (string[1] == 0) {
+		len = 1;
+		ret = string[0];
+	    } else {
+		return(string[0] + (string[1] << 8));
 	    }
 	}
-	if (ret)
+	/*
+	 * Skip to next node
+	 */
+        if ((tmp->children != NULL) &&
+            (tmp->type != XML_DTD_NODE) &&
+            (tmp->type != XML_ENTITY_REF_NODE) &&
+            (tmp->children->type != XML_ENTITY_DECL)) {
+            tmp = tmp->children;
+            continue;
+	}
+	if (tmp == node)
 	    break;
-    }
-    for (i = 0;i < ns1->nodeNr;i++)
-	if (values1[i] != NULL)
-	    xmlFree(values1[i]);
-    for (j = 0;j < ns2->nodeNr;j++)
-	if (values2[j] != NULL)
-	    xmlFree(values2[j]);
-    xmlFree(values1);
-    xmlFree(values2);
-    xmlFree(hashs1);
-    xmlFree(hashs2);
-    return(ret);
-}
 
-static int
-xmlXPathEqualValuesCommon(xmlXPathParserContextPtr ctxt,
-  xmlXPathObjectPtr arg1, xmlXPathObjectPtr arg2) {
-    int ret = 0;
-    /*
-     *At this point we are assured neither arg1 nor arg2
-     *is a nodeset, so we can just pick the appropriate routine.
-     */
-    switch (arg1->type) {
-        case XPATH_UNDEFINED:
-	    break;
-        case XPATH_BOOLEAN:
-	    switch (arg2->type) {
-	        case XPATH_UNDEFINED:
-		    break;
-		case XPATH_BOOLEAN:
-		    ret = (arg1->boolval == arg2->boolval);
-		    break;
-		case XPATH_NUMBER:
-		    ret = (arg1->boolval ==
-			   xmlXPathCastNumberToBoolean(arg2->floatval));
-		    break;
-		case XPATH_STRING:
-		    if ((arg2->stringval == NULL) ||
-			(arg2->stringval[0] == 0)) ret = 0;
-		    else
-			ret = 1;
-		    ret = (arg1->boolval == ret);
-		    break;
-		case XPATH_USERS:
-		    /* TODO */
-		    break;
-		case XPATH_NODESET:
-		case XPATH_XSLT_TREE:
-		    break;
-	    }
-	    break;
-        case XPATH_NUMBER:
-	    switch (arg2->type) {
-	        case XPATH_UNDEFINED:
-		    break;
-		case XPATH_BOOLEAN:
-		    ret = (arg2->boolval==
-			   xmlXPathCastNumberToBoolean(arg1->floatval));
-		    break;
-		case XPATH_STRING:
-		    xmlXPathValuePush(ctxt, arg2);
-		    xmlXPathNumberFunction(ctxt, 1);
-		    arg2 = xmlXPathValuePop(ctxt);
-                    if (ctxt->error)
-                        break;
-                    /* Falls through. */
-		case XPATH_NUMBER:
-		    /* Hand check NaN and Infinity equalities */
-		    if (xmlXPathIsNaN(arg1->floatval) ||
-			    xmlXPathIsNaN(arg2->floatval)) {
-		        ret = 0;
-		    } else if (xmlXPathIsInf(arg1->floatval) == 1) {
-		        if (xmlXPathIsInf(arg2->floatval) == 1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else if (xmlXPathIsInf(arg1->floatval) == -1) {
-			if (xmlXPathIsInf(arg2->floatval) == -1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else if (xmlXPathIsInf(arg2->floatval) == 1) {
-			if (xmlXPathIsInf(arg1->floatval) == 1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else if (xmlXPathIsInf(arg2->floatval) == -1) {
-			if (xmlXPathIsInf(arg1->floatval) == -1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else {
-		        ret = (arg1->floatval == arg2->floatval);
-		    }
-		    break;
-		case XPATH_USERS:
-		    /* TODO */
-		    break;
-		case XPATH_NODESET:
-		case XPATH_XSLT_TREE:
-		    break;
+	if (tmp->next != NULL) {
+	    tmp = tmp->next;
+	    continue;
+	}
+
+	do {
+	    tmp = tmp->parent;
+	    if (tmp == NULL)
+		break;
+	    if (tmp == node) {
+		tmp = NULL;
+		break;
 	    }
-	    break;
-        case XPATH_STRING:
-	    switch (arg2->type) {
-	        case XPATH_UNDEFINED:
-		    break;
-		case XPATH_BOOLEAN:
-		    if ((arg1->stringval == NULL) ||
-			(arg1->stringval[0] == 0)) ret = 0;
-		    else
-			ret = 1;
-		    ret = (arg2->boolval == ret);
-		    break;
-		case XPATH_STRING:
-		    ret = xmlStrEqual(arg1->stringval, arg2->stringval);
-		    break;
-		case XPATH_NUMBER:
-		    xmlXPathValuePush(ctxt, arg1);
-		    xmlXPathNumberFunction(ctxt, 1);
-		    arg1 = xmlXPathValuePop(ctxt);
-                    if (ctxt->error)
-                        break;
-		    /* Hand check NaN and Infinity equalities */
-		    if (xmlXPathIsNaN(arg1->floatval) ||
-			    xmlXPathIsNaN(arg2->floatval)) {
-		        ret = 0;
-		    } else if (xmlXPathIsInf(arg1->floatval) == 1) {
-			if (xmlXPathIsInf(arg2->floatval) == 1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else if (xmlXPathIsInf(arg1->floatval) == -1) {
-			if (xmlXPathIsInf(arg2->floatval) == -1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else if (xmlXPathIsInf(arg2->floatval) == 1) {
-			if (xmlXPathIsInf(arg1->floatval) == 1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else if (xmlXPathIsInf(arg2->floatval) == -1) {
-			if (xmlXPathIsInf(arg1->floatval) == -1)
-			    ret = 1;
-			else
-			    ret = 0;
-		    } else {
-		        ret = (arg1->floatval == arg2->floatval);
-		    }
-		    break;
-		case XPATH_USERS:
-		    /* TODO */
-		    break;
-		case XPATH_NODESET:
-		case XPATH_XSLT_TREE:
-		    break;
+	    if (tmp->next != NULL) {
+		tmp = tmp->next;
+		break;
 	    }
-	    break;
-        case XPATH_USERS:
-	    /* TODO */
-	    break;
-	case XPATH_NODESET:
-	case XPATH_XSLT_TREE:
-	    break;
+	} while (tmp != NULL);
     }
-    xmlXPathReleaseObject(ctxt->context, arg1);
-    xmlXPathReleaseObject(ctxt->context, arg2);
     return(ret);
 }
 
 /**
- * Implement the equal operation on XPath objects content: `arg1` == `arg2`
+ * Function computing the beginning of the string value of the node,
+ * used to speed up comparisons
  *
- * @param ctxt  the XPath Parser context
- * @returns 0 or 1 depending on the results of the test.
+ * @param string  a string
+ * @returns an int usable as a hash
  */
-int
-xmlXPathEqualValues(xmlXPathParserContext *ctxt) {
-    xmlXPathObjectPtr arg1, arg2, argtmp;
-    int ret = 0;
-
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(0);
-    arg2 = xmlXPathValuePop(ctxt);
-    arg1 = xmlXPathValuePop(ctxt);
-    if ((arg1 == NULL) || (arg2 == NULL)) {
-	if (arg1 != NULL)
-	    xmlXPathReleaseObject(ctxt->context, arg1);
-	else
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-	XP_ERROR0(XPATH_INVALID_OPERAND);
-    }
+static unsigned int
+xmlXPathStringHash(const xmlChar * string) {
+    if (string == NULL)
+	return(0);
+    if (string[0] == 0)
+	return(0);
+    return(string[0] + (string[1] << 8));
+}
 
-    if (arg1 == arg2) {
-	xmlXPathFreeObject(arg1);
-        return(1);
-    }
+/**
+ * Compute the range of the numeric values of the nodes in a node-set,
+ * ignoring NaN.
+ *
+ * @param ctxt  XPath parser context
+ * @param ns  the node-set
+ * @param min  pointer to the minimum
+ * @param max  pointer to the maximum
+ * @returns 1 if a node has a numeric value, 0 otherwise.
+ */
+static int
+xmlXPathNodeSetNumberRange(xmlXPathParserContextPtr ctxt, xmlNodeSetPtr ns,
+                           double *min, double *max) {
+    double val;
+    int i, found = 0;
 
-    /*
-     *If either argument is a nodeset, it's a 'special case'
-     */
-    if ((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE) ||
-      (arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
-	/*
-	 *Hack it to assure arg1 is the nodeset
-	 */
-	if ((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE)) {
-		argtmp = arg2;
-		arg2 = arg1;
-		arg1 = argtmp;
-	}
-	switch (arg2->type) {
-	    case XPATH_UNDEFINED:
-		break;
-	    case XPATH_NODESET:
-	    case XPATH_XSLT_TREE:
-		ret = xmlXPathEqualNodeSets(ctxt, arg1, arg2, 0);
-		break;
-	    case XPATH_BOOLEAN:
-		if ((arg1->nodesetval == NULL) ||
-		  (arg1->nodesetval->nodeNr == 0)) ret = 0;
-		else
-		    ret = 1;
-		ret = (ret == arg2->boolval);
-		break;
-	    case XPATH_NUMBER:
-		ret = xmlXPathEqualNodeSetFloat(ctxt, arg1, arg2->floatval, 0);
-		break;
-	    case XPATH_STRING:
-		ret = xmlXPathEqualNodeSetString(ctxt, arg1,
-                                                 arg2->stringval, 0);
-		break;
-	    case XPATH_USERS:
-		/* TODO */
-		break;
-	}
-	xmlXPathReleaseObject(ctxt->context, arg1);
-	xmlXPathReleaseObject(ctxt->context, arg2);
-	return(ret);
+    for (i = 0; i < ns->nodeNr; i++) {
+        val = xmlXPathNodeToNumberInternal(ctxt, ns->nodeTab[i]);
+        if (xmlXPathIsNaN(val))
+            continue;
+        if ((!found) || (val < *min))
+            *min = val;
+        if ((!found) || (val > *max))
+            *max = val;
+        found = 1;
     }
-
-    return (xmlXPathEqualValuesCommon(ctxt, arg1, arg2));
+    return(found);
 }
 
 /**
- * Implement the equal operation on XPath objects content: `arg1` == `arg2`
+ * Implement the compare operation between a nodeset and a number
+ *     `ns` < `val`    (1, 1, ...
+ *     `ns` <= `val`   (1, 0, ...
+ *     `ns` > `val`    (0, 1, ...
+ *     `ns` >= `val`   (0, 0, ...
+ *
+ * If one object to be compared is a node-set and the other is a number,
+ * then the comparison will be true if and only if there is a node in the
+ * node-set such that the result of performing the comparison on the number
+ * to be compared and on the result of converting the string-value of that
+ * node to a number using the number function is true.
  *
  * @param ctxt  the XPath Parser context
- * @returns 0 or 1 depending on the results of the test.
+ * @param inf  less than (1) or greater than (0)
+ * @param strict  is the comparison strict
+ * @param arg  the node set
+ * @param f  the value
+ * @returns 0 or 1 depending on the results of the test.
  */
-int
-xmlXPathNotEqualValues(xmlXPathParserContext *ctxt) {
-    xmlXPathObjectPtr arg1, arg2, argtmp;
-    int ret = 0;
-
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(0);
-    arg2 = xmlXPathValuePop(ctxt);
-    arg1 = xmlXPathValuePop(ctxt);
-    if ((arg1 == NULL) || (arg2 == NULL)) {
-	if (arg1 != NULL)
-	    xmlXPathReleaseObject(ctxt->context, arg1);
-	else
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-	XP_ERROR0(XPATH_INVALID_OPERAND);
-    }
+static int
+xmlXPathCompareNodeSetFloat(xmlXPathParserContextPtr ctxt, int inf, int strict,
+	                    xmlXPathObjectPtr arg, xmlXPathObjectPtr f) {
+    int i, ret = 0;
+    xmlNodeSetPtr ns;
+    xmlChar *str2;
 
-    if (arg1 == arg2) {
-	xmlXPathReleaseObject(ctxt->context, arg1);
+    if ((f == NULL) || (arg == NULL) ||
+	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE))) {
+	xmlXPathReleaseObject(ctxt->context, arg);
+	xmlXPathReleaseObject(ctxt->context, f);
         return(0);
     }
-
-    /*
-     *If either argument is a nodeset, it's a 'special case'
-     */
-    if ((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE) ||
-      (arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
-	/*
-	 *Hack it to assure arg1 is the nodeset
-	 */
-	if ((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE)) {
-		argtmp = arg2;
-		arg2 = arg1;
-		arg1 = argtmp;
-	}
-	switch (arg2->type) {
-	    case XPATH_UNDEFINED:
-		break;
-	    case XPATH_NODESET:
-	    case XPATH_XSLT_TREE:
-		ret = xmlXPathEqualNodeSets(ctxt, arg1, arg2, 1);
-		break;
-	    case XPATH_BOOLEAN:
-		if ((arg1->nodesetval == NULL) ||
-		  (arg1->nodesetval->nodeNr == 0)) ret = 0;
-		else
-		    ret = 1;
-		ret = (ret != arg2->boolval);
-		break;
-	    case XPATH_NUMBER:
-		ret = xmlXPathEqualNodeSetFloat(ctxt, arg1, arg2->floatval, 1);
-		break;
-	    case XPATH_STRING:
-		ret = xmlXPathEqualNodeSetString(ctxt, arg1,
-                                                 arg2->stringval, 1);
-		break;
-	    case XPATH_USERS:
-		/* TODO */
-		break;
+    ns = arg->nodesetval;
+    if (ns != NULL) {
+	for (i = 0;i < ns->nodeNr;i++) {
+	     str2 = xmlXPathCastNodeToString(ns->nodeTab[i]);
+	     if (str2 != NULL) {
+		 xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt, str2));
+		 xmlFree(str2);
+		 xmlXPathNumberFunction(ctxt, 1);
+		 xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, f));
+		 ret = xmlXPathCompareValues(ctxt, inf, strict);
+		 if (ret)
+		     break;
+	     } else {
+                 xmlXPathPErrMemory(ctxt);
+             }
 	}
-	xmlXPathReleaseObject(ctxt->context, arg1);
-	xmlXPathReleaseObject(ctxt->context, arg2);
-	return(ret);
     }
-
-    return (!xmlXPathEqualValuesCommon(ctxt, arg1, arg2));
+    xmlXPathReleaseObject(ctxt->context, arg);
+    xmlXPathReleaseObject(ctxt->context, f);
+    return(ret);
 }
 
 /**
- * Implement the compare operation on XPath objects:
- *     `arg1` < `arg2`    (1, 1, ...
- *     `arg1` <= `arg2`   (1, 0, ...
- *     `arg1` > `arg2`    (0, 1, ...
- *     `arg1` >= `arg2`   (0, 0, ...
+ * Implement the compare operation between a nodeset and a string
+ *     `ns` < `val`    (1, 1, ...
+ *     `ns` <= `val`   (1, 0, ...
+ *     `ns` > `val`    (0, 1, ...
+ *     `ns` >= `val`   (0, 0, ...
  *
- * When neither object to be compared is a node-set and the operator is
- * <=, <, >=, >, then the objects are compared by converted both objects
- * to numbers and comparing the numbers according to IEEE 754. The <
- * comparison will be true if and only if the first number is less than the
- * second number. The <= comparison will be true if and only if the first
- * number is less than or equal to the second number. The > comparison
- * will be true if and only if the first number is greater than the second
- * number. The >= comparison will be true if and only if the first number
- * is greater than or equal to the second number.
+ * If one object to be compared is a node-set and the other is a string,
+ * then the comparison will be true if and only if there is a node in
+ * the node-set such that the result of performing the comparison on the
+ * string-value of the node and the other string is true.
  *
  * @param ctxt  the XPath Parser context
  * @param inf  less than (1) or greater than (0)
  * @param strict  is the comparison strict
- * @returns 1 if the comparison succeeded, 0 if it failed
+ * @param arg  the node set
+ * @param s  the value
+ * @returns 0 or 1 depending on the results of the test.
  */
-int
-xmlXPathCompareValues(xmlXPathParserContext *ctxt, int inf, int strict) {
-    int ret = 0, arg1i = 0, arg2i = 0;
-    xmlXPathObjectPtr arg1, arg2;
-
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(0);
-    arg2 = xmlXPathValuePop(ctxt);
-    arg1 = xmlXPathValuePop(ctxt);
-    if ((arg1 == NULL) || (arg2 == NULL)) {
-	if (arg1 != NULL)
-	    xmlXPathReleaseObject(ctxt->context, arg1);
-	else
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-	XP_ERROR0(XPATH_INVALID_OPERAND);
-    }
-
-    if ((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE) ||
-      (arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
-	/*
-	 * If either argument is a XPATH_NODESET or XPATH_XSLT_TREE the two arguments
-	 * are not freed from within this routine; they will be freed from the
-	 * called routine, e.g. xmlXPathCompareNodeSets or xmlXPathCompareNodeSetValue
-	 */
-	if (((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE)) &&
-	  ((arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE))){
-	    ret = xmlXPathCompareNodeSets(ctxt, inf, strict, arg1, arg2);
-	} else {
-	    if ((arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
-		ret = xmlXPathCompareNodeSetValue(ctxt, inf, strict,
-			                          arg1, arg2);
-	    } else {
-		ret = xmlXPathCompareNodeSetValue(ctxt, !inf, strict,
-			                          arg2, arg1);
-	    }
-	}
-	return(ret);
-    }
+static int
+xmlXPathCompareNodeSetString(xmlXPathParserContextPtr ctxt, int inf, int strict,
+	                    xmlXPathObjectPtr arg, xmlXPathObjectPtr s) {
+    int i, ret = 0;
+    xmlNodeSetPtr ns;
+    xmlChar *str2;
 
-    if (arg1->type != XPATH_NUMBER) {
-	xmlXPathValuePush(ctxt, arg1);
-	xmlXPathNumberFunction(ctxt, 1);
-	arg1 = xmlXPathValuePop(ctxt);
-    }
-    if (arg2->type != XPATH_NUMBER) {
-	xmlXPathValuePush(ctxt, arg2);
-	xmlXPathNumberFunction(ctxt, 1);
-	arg2 = xmlXPathValuePop(ctxt);
+    if ((s == NULL) || (arg == NULL) ||
+	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE))) {
+	xmlXPathReleaseObject(ctxt->context, arg);
+	xmlXPathReleaseObject(ctxt->context, s);
+        return(0);
     }
-    if (ctxt->error)
-        goto error;
-    /*
-     * Add tests for infinity and nan
-     * => feedback on 3.4 for Inf and NaN
-     */
-    /* Hand check NaN and Infinity comparisons */
-    if (xmlXPathIsNaN(arg1->floatval) || xmlXPathIsNaN(arg2->floatval)) {
-	ret=0;
-    } else {
-	arg1i=xmlXPathIsInf(arg1->floatval);
-	arg2i=xmlXPathIsInf(arg2->floatval);
-	if (inf && strict) {
-	    if ((arg1i == -1 && arg2i != -1) ||
-		(arg2i == 1 && arg1i != 1)) {
-		ret = 1;
-	    } else if (arg1i == 0 && arg2i == 0) {
-		ret = (arg1->floatval < arg2->floatval);
-	    } else {
-		ret = 0;
-	    }
-	}
-	else if (inf && !strict) {
-	    if (arg1i == -1 || arg2i == 1) {
-		ret = 1;
-	    } else if (arg1i == 0 && arg2i == 0) {
-		ret = (arg1->floatval <= arg2->floatval);
-	    } else {
-		ret = 0;
-	    }
-	}
-	else if (!inf && strict) {
-	    if ((arg1i == 1 && arg2i != 1) ||
-		(arg2i == -1 && arg1i != -1)) {
-		ret = 1;
-	    } else if (arg1i == 0 && arg2i == 0) {
-		ret = (arg1->floatval > arg2->floatval);
-	    } else {
-		ret = 0;
-	    }
-	}
-	else if (!inf && !strict) {
-	    if (arg1i == 1 || arg2i == -1) {
-		ret = 1;
-	    } else if (arg1i == 0 && arg2i == 0) {
-		ret = (arg1->floatval >= arg2->floatval);
-	    } else {
-		ret = 0;
-	    }
+    ns = arg->nodesetval;
+    if (ns != NULL) {
+	for (i = 0;i < ns->nodeNr;i++) {
+	     str2 = xmlXPathCastNodeToString(ns->nodeTab[i]);
+	     if (str2 != NULL) {
+		 xmlXPathValuePush(ctxt,
+			   xmlXPathCacheNewString(ctxt, str2));
+		 xmlFree(str2);
+		 xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, s));
+		 ret = xmlXPathCompareValues(ctxt, inf, strict);
+		 if (ret)
+		     break;
+	     } else {
+                 xmlXPathPErrMemory(ctxt);
+             }
 	}
     }
-error:
-    xmlXPathReleaseObject(ctxt->context, arg1);
-    xmlXPathReleaseObject(ctxt->context, arg2);
+    xmlXPathReleaseObject(ctxt->context, arg);
+    xmlXPathReleaseObject(ctxt->context, s);
     return(ret);
 }
 
 /**
- * Implement the unary - operation on an XPath object
- * The numeric operators convert their operands to numbers as if
- * by calling the number function.
+ * Implement the compare operation on nodesets:
  *
- * @param ctxt  the XPath Parser context
- */
-void
-xmlXPathValueFlipSign(xmlXPathParserContext *ctxt) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return;
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
-    ctxt->value->floatval = -ctxt->value->floatval;
-}
-
-/**
- * Implement the add operation on XPath objects:
- * The numeric operators convert their operands to numbers as if
- * by calling the number function.
+ * If both objects to be compared are node-sets, then the comparison
+ * will be true if and only if there is a node in the first node-set
+ * and a node in the second node-set such that the result of performing
+ * the comparison on the string-values of the two nodes is true.
+ * ....
+ * When neither object to be compared is a node-set and the operator
+ * is <=, <, >= or >, then the objects are compared by converting both
+ * objects to numbers and comparing the numbers according to IEEE 754.
+ * ....
+ * The number function converts its argument to a number as follows:
+ *  - a string that consists of optional whitespace followed by an
+ *    optional minus sign followed by a Number followed by whitespace
+ *    is converted to the IEEE 754 number that is nearest (according
+ *    to the IEEE 754 round-to-nearest rule) to the mathematical value
+ *    represented by the string; any other string is converted to NaN
  *
- * @param ctxt  the XPath Parser context
+ * Conclusion all nodes need to be converted first to their string value
+ * and then the comparison must be done when possible
+ *
+ * @param ctxt  XPath parser context
+ * @param inf  less than (1) or greater than (0)
+ * @param strict  is the comparison strict
+ * @param arg1  the first node set object
+ * @param arg2  the second node set object
  */
-void
-xmlXPathAddValues(xmlXPathParserContext *ctxt) {
-    xmlXPathObjectPtr arg;
-    double val;
+static int
+xmlXPathCompareNodeSets(xmlXPathParserContextPtr ctxt, int inf, int strict,
+	                xmlXPathObjectPtr arg1, xmlXPathObjectPtr arg2) {
+    double min1, max1, min2, max2;
+    int ret = 0;
+    xmlNodeSetPtr ns1;
+    xmlNodeSetPtr ns2;
 
-    arg = xmlXPathValuePop(ctxt);
-    if (arg == NULL)
-	XP_ERROR(XPATH_INVALID_OPERAND);
-    val = xmlXPathCastToNumberInternal(ctxt, arg);
-    xmlXPathReleaseObject(ctxt->context, arg);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
-    ctxt->value->floatval += val;
-}
+    if ((arg1 == NULL) ||
+	((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE))) {
+	xmlXPathFreeObject(arg2);
+        return(0);
+    }
+    if ((arg2 == NULL) ||
+	((arg2->type != XPATH_NODESET) && (arg2->type != XPATH_XSLT_TREE))) {
+	xmlXPathFreeObject(arg1);
+	xmlXPathFreeObject(arg2);
+        return(0);
+    }
 
-/**
- * Implement the subtraction operation on XPath objects:
- * The numeric operators convert their operands to numbers as if
- * by calling the number function.
- *
- * @param ctxt  the XPath Parser context
- */
-void
-xmlXPathSubValues(xmlXPathParserContext *ctxt) {
-    xmlXPathObjectPtr arg;
-    double val;
+    ns1 = arg1->nodesetval;
+    ns2 = arg2->nodesetval;
 
-    arg = xmlXPathValuePop(ctxt);
-    if (arg == NULL)
-	XP_ERROR(XPATH_INVALID_OPERAND);
-    val = xmlXPathCastToNumberInternal(ctxt, arg);
-    xmlXPathReleaseObject(ctxt->context, arg);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
-    ctxt->value->floatval -= val;
+    if ((ns1 == NULL) || (ns1->nodeNr <= 0)) {
+	xmlXPathFreeObject(arg1);
+	xmlXPathFreeObject(arg2);
+	return(0);
+    }
+    if ((ns2 == NULL) || (ns2->nodeNr <= 0)) {
+	xmlXPathFreeObject(arg1);
+	xmlXPathFreeObject(arg2);
+	return(0);
+    }
+
+    /*
+     * A pair of nodes satisfies the comparison if and only if the
+     * minimum of one set and the maximum of the other one do.
+     */
+    if ((xmlXPathNodeSetNumberRange(ctxt, ns1, &min1, &max1)) &&
+        (xmlXPathNodeSetNumberRange(ctxt, ns2, &min2, &max2))) {
+        if (inf && strict)
+            ret = (min1 < max2);
+        else if (inf && !strict)
+            ret = (min1 <= max2);
+        else if (!inf && strict)
+            ret = (max1 > min2);
+        else
+            ret = (max1 >= min2);
+    }
+    xmlXPathFreeObject(arg1);
+    xmlXPathFreeObject(arg2);
+    return(ret);
 }
 
 /**
- * Implement the multiply operation on XPath objects:
- * The numeric operators convert their operands to numbers as if
- * by calling the number function.
+ * Implement the compare operation between a nodeset and a value
+ *     `ns` < `val`    (1, 1, ...
+ *     `ns` <= `val`   (1, 0, ...
+ *     `ns` > `val`    (0, 1, ...
+ *     `ns` >= `val`   (0, 0, ...
+ *
+ * If one object to be compared is a node-set and the other is a boolean,
+ * then the comparison will be true if and only if the result of performing
+ * the comparison on the boolean and on the result of converting
+ * the node-set to a boolean using the boolean function is true.
  *
  * @param ctxt  the XPath Parser context
+ * @param inf  less than (1) or greater than (0)
+ * @param strict  is the comparison strict
+ * @param arg  the node set
+ * @param val  the value
+ * @returns 0 or 1 depending on the results of the test.
  */
-void
-xmlXPathMultValues(xmlXPathParserContext *ctxt) {
-    xmlXPathObjectPtr arg;
-    double val;
+static int
+xmlXPathCompareNodeSetValue(xmlXPathParserContextPtr ctxt, int inf, int strict,
+	                    xmlXPathObjectPtr arg, xmlXPathObjectPtr val) {
+    if ((val == NULL) || (arg == NULL) ||
+	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE)))
+        return(0);
 
-    arg = xmlXPathValuePop(ctxt);
-    if (arg == NULL)
-	XP_ERROR(XPATH_INVALID_OPERAND);
-    val = xmlXPathCastToNumberInternal(ctxt, arg);
-    xmlXPathReleaseObject(ctxt->context, arg);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
-    ctxt->value->floatval *= val;
+    switch(val->type) {
+        case XPATH_NUMBER:
+	    return(xmlXPathCompareNodeSetFloat(ctxt, inf, strict, arg, val));
+        case XPATH_NODESET:
+        case XPATH_XSLT_TREE:
+	    return(xmlXPathCompareNodeSets(ctxt, inf, strict, arg, val));
+        case XPATH_STRING:
+	    return(xmlXPathCompareNodeSetString(ctxt, inf, strict, arg, val));
+        case XPATH_BOOLEAN:
+	    xmlXPathValuePush(ctxt, arg);
+	    xmlXPathBooleanFunction(ctxt, 1);
+	    xmlXPathValuePush(ctxt, val);
+	    return(xmlXPathCompareValues(ctxt, inf, strict));
+	default:
+            xmlXPathReleaseObject(ctxt->context, arg);
+            xmlXPathReleaseObject(ctxt->context, val);
+            XP_ERROR0(XPATH_INVALID_TYPE);
+    }
+    return(0);
 }
 
 /**
- * Implement the div operation on XPath objects `arg1` / `arg2`.
- * The numeric operators convert their operands to numbers as if
- * by calling the number function.
+ * Implement the equal operation on XPath objects content: `arg1` == `arg2`
+ * If one object to be compared is a node-set and the other is a string,
+ * then the comparison will be true if and only if there is a node in
+ * the node-set such that the result of performing the comparison on the
+ * string-value of the node and the other string is true.
  *
- * @param ctxt  the XPath Parser context
+ * @param ctxt  XPath parser context
+ * @param arg  the nodeset object argument
+ * @param str  the string to compare to.
+ * @param neq  flag to show whether for '=' (0) or '!=' (1)
+ * @returns 0 or 1 depending on the results of the test.
  */
-ATTRIBUTE_NO_SANITIZE("float-divide-by-zero")
-void
-xmlXPathDivValues(xmlXPathParserContext *ctxt) {
-    xmlXPathObjectPtr arg;
-    double val;
+static int
+xmlXPathEqualNodeSetString(xmlXPathParserContextPtr ctxt,
+                           xmlXPathObjectPtr arg, const xmlChar * str, int neq)
+{
+    int i;
+    xmlNodeSetPtr ns;
+    const xmlChar *str2;
+    xmlChar *mem;
+    unsigned int hash;
 
-    arg = xmlXPathValuePop(ctxt);
-    if (arg == NULL)
-	XP_ERROR(XPATH_INVALID_OPERAND);
-    val = xmlXPathCastToNumberInternal(ctxt, arg);
-    xmlXPathReleaseObject(ctxt->context, arg);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
-    ctxt->value->floatval /= val;
+    if ((str == NULL) || (arg == NULL) ||
+        ((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE)))
+        return (0);
+    ns = arg->nodesetval;
+    /*
+     * A NULL nodeset compared with a string is always false
+     * (since there is no node equal, and no node not equal)
+     */
+    if ((ns == NULL) || (ns->nodeNr <= 0) )
+        return (0);
+    hash = xmlXPathStringHash(str);
+    for (i = 0; i < ns->nodeNr; i++) {
+        if (xmlXPathNodeValHash(ns->nodeTab[i]) == hash) {
+            str2 = xmlNodeBorrowContent(ns->nodeTab[i], &mem);
+            if (str2 == NULL) {
+                xmlXPathPErrMemory(ctxt);
+                return(0);
+            }
+            if (xmlStrEqual(str, str2)) {
+                xmlFree(mem);
+		if (neq)
+		    continue;
+                return (1);
+            } else if (neq) {
+		xmlFree(mem);
+		return (1);
+	    }
+            xmlFree(mem);
+        } else if (neq)
+	    return (1);
+    }
+    return (0);
 }
 
 /**
- * Implement the mod operation on XPath objects: `arg1` / `arg2`
- * The numeric operators convert their operands to numbers as if
- * by calling the number function.
+ * Implement the equal operation on XPath objects content: `arg1` == `arg2`
+ * If one object to be compared is a node-set and the other is a number,
+ * then the comparison will be true if and only if there is a node in
+ * the node-set such that the result of performing the comparison on the
+ * number to be compared and on the result of converting the string-value
+ * of that node to a number using the number function is true.
  *
- * @param ctxt  the XPath Parser context
+ * @param ctxt  XPath parser context
+ * @param arg  the nodeset object argument
+ * @param f  the float to compare to
+ * @param neq  flag to show whether to compare '=' (0) or '!=' (1)
+ * @returns 0 or 1 depending on the results of the test.
  */
-void
-xmlXPathModValues(xmlXPathParserContext *ctxt) {
-    xmlXPathObjectPtr arg;
-    double arg1, arg2;
+static int
+xmlXPathEqualNodeSetFloat(xmlXPathParserContextPtr ctxt,
+    xmlXPathObjectPtr arg, double f, int neq) {
+  int i, ret=0;
+  xmlNodeSetPtr ns;
+  xmlChar *str2;
+  xmlXPathObjectPtr val;
+  double v;
 
-    arg = xmlXPathValuePop(ctxt);
-    if (arg == NULL)
-	XP_ERROR(XPATH_INVALID_OPERAND);
-    arg2 = xmlXPathCastToNumberInternal(ctxt, arg);
-    xmlXPathReleaseObject(ctxt->context, arg);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
-    arg1 = ctxt->value->floatval;
-    if (arg2 == 0)
-	ctxt->value->floatval = xmlXPathNAN;
-    else {
-	ctxt->value->floatval = fmod(arg1, arg2);
-    }
-}
+    if ((arg == NULL) ||
+	((arg->type != XPATH_NODESET) && (arg->type != XPATH_XSLT_TREE)))
+        return(0);
 
-/************************************************************************
- *									*
- *		The traversal functions					*
- *									*
- ************************************************************************/
+    ns = arg->nodesetval;
+    if (ns != NULL) {
+	for (i=0;i<ns->nodeNr;i++) {
+	    str2 = xmlXPathCastNodeToString(ns->nodeTab[i]);
+	    if (str2 != NULL) {
+		xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt, str2));
+		xmlFree(str2);
+		xmlXPathNumberFunction(ctxt, 1);
+                CHECK_ERROR0;
+		val = xmlXPathValuePop(ctxt);
+		v = val->floatval;
+		xmlXPathReleaseObject(ctxt->context, val);
+		if (!xmlXPathIsNaN(v)) {
+		    if ((!neq) && (v==f)) {
+			ret = 1;
+			break;
+		    } else if ((neq) && (v!=f)) {
+			ret = 1;
+			break;
+		    }
+		} else {	/* NaN is unequal to any value */
+		    if (neq)
+			ret = 1;
+		}
+	    } else {
+                xmlXPathPErrMemory(ctxt);
+            }
+	}
+    }
 
-/*
- * A traversal function enumerates nodes along an axis.
- * Initially it must be called with NULL, and it indicates
- * termination on the axis by returning NULL.
- */
-typedef xmlNode *(*xmlXPathTraversalFunction)
-                    (xmlXPathParserContext *ctxt, xmlNode *cur);
+    return(ret);
+}
 
-/*
- * A traversal function enumerates nodes along an axis.
- * Initially it must be called with NULL, and it indicates
- * termination on the axis by returning NULL.
- * The context node of the traversal is specified via `contextNode`.
- */
-typedef xmlNode *(*xmlXPathTraversalFunctionExt)
-                    (xmlNode *cur, xmlNode *contextNode);
 
 /*
- * Used for merging node sets in #xmlXPathCollectAndTest.
+ * Minimum number of node pairs for which node-set equality is computed
+ * with a hash table instead of comparing every pair.
  */
-typedef xmlNodeSet *(*xmlXPathNodeSetMergeFunction)
-		    (xmlNodeSet *, xmlNodeSet *);
-
+#define XPATH_HASH_JOIN_MIN_PAIRS 1000
 
 /**
- * Traversal function for the "self" direction
- * The self axis contains just the context node itself
+ * Implement the equal / not equal operation on large nodesets in
+ * linear time.
  *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-xmlNode *
-xmlXPathNextSelf(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL)
-        return(ctxt->context->node);
-    return(NULL);
-}
-
-/**
- * Traversal function for the "child" direction
- * The child axis contains the children of the context node in document order.
+ * For equality, the string values of the smaller set are stored in
+ * a hash table which is then probed with the values of the larger
+ * set. Two sets are not equal if any of their values differs from
+ * the value of the first node.
  *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
+ * @param ctxt  XPath parser context
+ * @param ns1  first nodeset
+ * @param ns2  second nodeset
+ * @param neq  flag to show whether to test '=' (0) or '!=' (1)
+ * @returns 0 or 1 depending on the results of the test.
  */
-xmlNode *
-xmlXPathNextChild(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL) {
-	if (ctxt->context->node == NULL) return(NULL);
-	switch (ctxt->context->node->type) {
-            case XML_ELEMENT_NODE:
-            case XML_TEXT_NODE:
-            case XML_CDATA_SECTION_NODE:
-            case XML_ENTITY_REF_NODE:
-            case XML_ENTITY_NODE:
-            case XML_PI_NODE:
-            case XML_COMMENT_NODE:
-            case XML_NOTATION_NODE:
-            case XML_DTD_NODE:
-		return(ctxt->context->node->children);
-            case XML_DOCUMENT_NODE:
-            case XML_DOCUMENT_TYPE_NODE:
-            case XML_DOCUMENT_FRAG_NODE:
-            case XML_HTML_DOCUMENT_NODE:
-		return(((xmlDocPtr) ctxt->context->node)->children);
-	    case XML_ELEMENT_DECL:
-	    case XML_ATTRIBUTE_DECL:
-	    case XML_ENTITY_DECL:
-            case XML_ATTRIBUTE_NODE:
-	    case XML_NAMESPACE_DECL:
-	    case XML_XINCLUDE_START:
-	    case XML_XINCLUDE_END:
-		return(NULL);
-	}
-	return(NULL);
+static int
+xmlXPathEqualNodeSetsHash(xmlXPathParserContextPtr ctxt, xmlNodeSetPtr ns1,
+                          xmlNodeSetPtr ns2, int neq) {
+    xmlHashTablePtr hash;
+    xmlNodeSetPtr build, probe, set;
+    xmlChar *strval, *first, *mem;
+    const xmlChar *cstrval;
+    unsigned int hash0;
+    int i, k, ret = 0;
+
+    if (neq) {
+        first = xmlXPathCastNodeToString(ns1->nodeTab[0]);
+        if (first == NULL) {
+            xmlXPathPErrMemory(ctxt);
+            return(0);
+        }
+        hash0 = xmlXPathNodeValHash(ns1->nodeTab[0]);
+        for (k = 0; (k < 2) && (ret == 0); k++) {
+            set = (k == 0) ? ns1 : ns2;
+            for (i = 0; i < set->nodeNr; i++) {
+                if (xmlXPathNodeValHash(set->nodeTab[i]) != hash0) {
+                    ret = 1;
+                    break;
+                }
+                cstrval = xmlNodeBorrowContent(set->nodeTab[i], &mem);
+                if (cstrval == NULL) {
+                    xmlXPathPErrMemory(ctxt);
+                    break;
+                }
+                ret = !xmlStrEqual(first, cstrval);
+                xmlFree(mem);
+                if (ret)
+                    break;
+            }
+        }
+        xmlFree(first);
+        return(ret);
     }
-    if ((cur->type == XML_DOCUMENT_NODE) ||
-        (cur->type == XML_HTML_DOCUMENT_NODE))
-	return(NULL);
-    return(cur->next);
-}
 
-/**
- * Traversal function for the "child" direction and nodes of type element.
- * The child axis contains the children of the context node in document order.
- *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-static xmlNodePtr
-xmlXPathNextChildElement(xmlXPathParserContextPtr ctxt, xmlNodePtr cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL) {
-	cur = ctxt->context->node;
-	if (cur == NULL) return(NULL);
-	/*
-	* Get the first element child.
-	*/
-	switch (cur->type) {
-            case XML_ELEMENT_NODE:
-	    case XML_DOCUMENT_FRAG_NODE:
-	    case XML_ENTITY_REF_NODE: /* URGENT TODO: entify-refs as well? */
-            case XML_ENTITY_NODE:
-		cur = cur->children;
-		if (cur != NULL) {
-		    if (cur->type == XML_ELEMENT_NODE)
-			return(cur);
-		    do {
-			cur = cur->next;
-		    } while ((cur != NULL) &&
-			(cur->type != XML_ELEMENT_NODE));
-		    return(cur);
-		}
-		return(NULL);
-            case XML_DOCUMENT_NODE:
-            case XML_HTML_DOCUMENT_NODE:
-		return(xmlDocGetRootElement((xmlDocPtr) cur));
-	    default:
-		return(NULL);
-	}
-	return(NULL);
+    if (ns1->nodeNr <= ns2->nodeNr) {
+        build = ns1;
+        probe = ns2;
+    } else {
+        build = ns2;
+        probe = ns1;
     }
-    /*
-    * Get the next sibling element node.
-    */
-    switch (cur->type) {
-	case XML_ELEMENT_NODE:
-	case XML_TEXT_NODE:
-	case XML_ENTITY_REF_NODE:
-	case XML_ENTITY_NODE:
-	case XML_CDATA_SECTION_NODE:
-	case XML_PI_NODE:
-	case XML_COMMENT_NODE:
-	case XML_XINCLUDE_END:
-	    break;
-	/* case XML_DTD_NODE: */ /* URGENT TODO: DTD-node as well? */
-	default:
-	    return(NULL);
+
+    hash = xmlHashCreate(build->nodeNr);
+    if (hash == NULL) {
+        xmlXPathPErrMemory(ctxt);
+        return(0);
     }
-    if (cur->next != NULL) {
-	if (cur->next->type == XML_ELEMENT_NODE)
-	    return(cur->next);
-	cur = cur->next;
-	do {
-	    cur = cur->next;
-	} while ((cur != NULL) && (cur->type != XML_ELEMENT_NODE));
-	return(cur);
+    for (i = 0; i < build->nodeNr; i++) {
+        strval = xmlXPathCastNodeToString(build->nodeTab[i]);
+        if (strval == NULL) {
+            xmlXPathPErrMemory(ctxt);
+            goto done;
+        }
+        if (xmlHashLookup(hash, strval) == NULL) {
+            if (xmlHashAddEntry(hash, strval, strval) < 0) {
+                xmlXPathPErrMemory(ctxt);
+                xmlFree(strval);
+                goto done;
+            }
+        } else {
+            xmlFree(strval);
+        }
     }
-    return(NULL);
+    for (i = 0; i < probe->nodeNr; i++) {
+        cstrval = xmlNodeBorrowContent(probe->nodeTab[i], &mem);
+        if (cstrval == NULL) {
+            xmlXPathPErrMemory(ctxt);
+            break;
+        }
+        ret = (xmlHashLookup(hash, cstrval) != NULL);
+        xmlFree(mem);
+        if (ret)
+            break;
+    }
+
+done:
+    xmlHashFree(hash, xmlHashDefaultDeallocator);
+    return(ret);
 }
 
 /**
- * Traversal function for the "descendant" direction
- * the descendant axis contains the descendants of the context node in document
- * order; a descendant is a child or a child of a child and so on.
+ * Implement the equal / not equal operation on XPath nodesets:
+ * `arg1` == `arg2`  or  `arg1` != `arg2`
+ * If both objects to be compared are node-sets, then the comparison
+ * will be true if and only if there is a node in the first node-set and
+ * a node in the second node-set such that the result of performing the
+ * comparison on the string-values of the two nodes is true.
  *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
+ * (needless to say, this is a costly operation)
+ *
+ * @param ctxt  XPath parser context
+ * @param arg1  first nodeset object argument
+ * @param arg2  second nodeset object argument
+ * @param neq  flag to show whether to test '=' (0) or '!=' (1)
+ * @returns 0 or 1 depending on the results of the test.
  */
-xmlNode *
-xmlXPathNextDescendant(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL) {
-	if (ctxt->context->node == NULL)
-	    return(NULL);
-	if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
-	    (ctxt->context->node->type == XML_NAMESPACE_DECL))
-	    return(NULL);
+static int
+xmlXPathEqualNodeSets(xmlXPathParserContextPtr ctxt, xmlXPathObjectPtr arg1,
+                      xmlXPathObjectPtr arg2, int neq) {
+    int i, j;
+    unsigned int *hashs1;
+    unsigned int *hashs2;
+    xmlChar **values1;
+    xmlChar **values2;
+    int ret = 0;
+    xmlNodeSetPtr ns1;
+    xmlNodeSetPtr ns2;
 
-        if (ctxt->context->node == (xmlNodePtr) ctxt->context->doc)
-	    return(ctxt->context->doc->children);
-        return(ctxt->context->node->children);
-    }
-
-    if (cur->type == XML_NAMESPACE_DECL)
-        return(NULL);
-    if (cur->children != NULL) {
-	/*
-	 * Do not descend on entities declarations
-	 */
-	if (cur->children->type != XML_ENTITY_DECL) {
-	    cur = cur->children;
-	    /*
-	     * Skip DTDs
-	     */
-	    if (cur->type != XML_DTD_NODE)
-		return(cur);
-	}
-    }
-
-    if (cur == ctxt->context->node) return(NULL);
-
-    while (cur->next != NULL) {
-	cur = cur->next;
-	if ((cur->type != XML_ENTITY_DECL) &&
-	    (cur->type != XML_DTD_NODE))
-	    return(cur);
-    }
-
-    do {
-        cur = cur->parent;
-	if (cur == NULL) break;
-	if (cur == ctxt->context->node) return(NULL);
-	if (cur->next != NULL) {
-	    cur = cur->next;
-	    return(cur);
-	}
-    } while (cur != NULL);
-    return(cur);
-}
+    if ((arg1 == NULL) ||
+	((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE)))
+        return(0);
+    if ((arg2 == NULL) ||
+	((arg2->type != XPATH_NODESET) && (arg2->type != XPATH_XSLT_TREE)))
+        return(0);
 
-/**
- * Traversal function for the "descendant-or-self" direction
- * the descendant-or-self axis contains the context node and the descendants
- * of the context node in document order; thus the context node is the first
- * node on the axis, and the first child of the context node is the second node
- * on the axis
- *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-xmlNode *
-xmlXPathNextDescendantOrSelf(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL)
-        return(ctxt->context->node);
+    ns1 = arg1->nodesetval;
+    ns2 = arg2->nodesetval;
 
-    if (ctxt->context->node == NULL)
-        return(NULL);
-    if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
-        (ctxt->context->node->type == XML_NAMESPACE_DECL))
-        return(NULL);
+    if ((ns1 == NULL) || (ns1->nodeNr <= 0))
+	return(0);
+    if ((ns2 == NULL) || (ns2->nodeNr <= 0))
+	return(0);
 
-    return(xmlXPathNextDescendant(ctxt, cur));
-}
+    if ((double) ns1->nodeNr * ns2->nodeNr >= XPATH_HASH_JOIN_MIN_PAIRS)
+        return(xmlXPathEqualNodeSetsHash(ctxt, ns1, ns2, neq));
 
-/**
- * Traversal function for the "parent" direction
- * The parent axis contains the parent of the context node, if there is one.
- *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-xmlNode *
-xmlXPathNextParent(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
     /*
-     * the parent of an attribute or namespace node is the element
-     * to which the attribute or namespace node is attached
-     * Namespace handling !!!
+     * for equal, check if there is a node pertaining to both sets
      */
-    if (cur == NULL) {
-	if (ctxt->context->node == NULL) return(NULL);
-	switch (ctxt->context->node->type) {
-            case XML_ELEMENT_NODE:
-            case XML_TEXT_NODE:
-            case XML_CDATA_SECTION_NODE:
-            case XML_ENTITY_REF_NODE:
-            case XML_ENTITY_NODE:
-            case XML_PI_NODE:
-            case XML_COMMENT_NODE:
-            case XML_NOTATION_NODE:
-            case XML_DTD_NODE:
-	    case XML_ELEMENT_DECL:
-	    case XML_ATTRIBUTE_DECL:
-	    case XML_XINCLUDE_START:
-	    case XML_XINCLUDE_END:
-	    case XML_ENTITY_DECL:
-		if (ctxt->context->node->parent == NULL)
-		    return((xmlNodePtr) ctxt->context->doc);
-		if ((ctxt->context->node->parent->type == XML_ELEMENT_NODE) &&
-		    ((ctxt->context->node->parent->name[0] == ' ') ||
-		     (xmlStrEqual(ctxt->context->node->parent->name,
-				 BAD_CAST "fake node libxslt"))))
-		    return(NULL);
-		return(ctxt->context->node->parent);
-            case XML_ATTRIBUTE_NODE: {
-		xmlAttrPtr att = (xmlAttrPtr) ctxt->context->node;
+    if (neq == 0)
+	for (i = 0;i < ns1->nodeNr;i++)
+	    for (j = 0;j < ns2->nodeNr;j++)
+		if (ns1->nodeTab[i] == ns2->nodeTab[j])
+		    return(1);
 
-		return(att->parent);
+    values1 = (xmlChar **) xmlMalloc(ns1->nodeNr * sizeof(xmlChar *));
+    if (values1 == NULL) {
+        xmlXPathPErrMemory(ctxt);
+	return(0);
+    }
+    hashs1 = (unsigned int *) xmlMalloc(ns1->nodeNr * sizeof(unsigned int));
+    if (hashs1 == NULL) {
+        xmlXPathPErrMemory(ctxt);
+	xmlFree(values1);
+	return(0);
+    }
+    memset(values1, 0, ns1->nodeNr * sizeof(xmlChar *));
+    values2 = (xmlChar **) xmlMalloc(ns2->nodeNr * sizeof(xmlChar *));
+    if (values2 == NULL) {
+        xmlXPathPErrMemory(ctxt);
+	xmlFree(hashs1);
+	xmlFree(values1);
+	return(0);
+    }
+    hashs2 = (unsigned int *) xmlMalloc(ns2->nodeNr * sizeof(unsigned int));
+    if (hashs2 == NULL) {
+        xmlXPathPErrMemory(ctxt);
+	xmlFree(hashs1);
+	xmlFree(values1);
+	xmlFree(values2);
+	return(0);
+    }
+    memset(values2, 0, ns2->nodeNr * sizeof(xmlChar *));
+    for (i = 0;i < ns1->nodeNr;i++) {
+	hashs1[i] = xmlXPathNodeValHash(ns1->nodeTab[i]);
+	for (j = 0;j < ns2->nodeNr;j++) {
+	    if (i == 0)
+		hashs2[j] = xmlXPathNodeValHash(ns2->nodeTab[j]);
+	    if (hashs1[i] != hashs2[j]) {
+		if (neq) {
+		    ret = 1;
+		    break;
+		}
 	    }
-            case XML_DOCUMENT_NODE:
-            case XML_DOCUMENT_TYPE_NODE:
-            case XML_DOCUMENT_FRAG_NODE:
-            case XML_HTML_DOCUMENT_NODE:
-                return(NULL);
-	    case XML_NAMESPACE_DECL: {
-		xmlNsPtr ns = (xmlNsPtr) ctxt->context->node;
-
-		if ((ns->next != NULL) &&
-		    (ns->next->type != XML_NAMESPACE_DECL))
-		    return((xmlNodePtr) ns->next);
-                return(NULL);
+	    else {
+		if (values1[i] == NULL) {
+		    values1[i] = xmlNodeGetContent(ns1->nodeTab[i]);
+                    if (values1[i] == NULL)
+                        xmlXPathPErrMemory(ctxt);
+                }
+		if (values2[j] == NULL) {
+		    values2[j] = xmlNodeGetContent(ns2->nodeTab[j]);
+                    if (values2[j] == NULL)
+                        xmlXPathPErrMemory(ctxt);
+                }
+		ret = xmlStrEqual(values1[i], values2[j]) ^ neq;
+		if (ret)
+		    break;
 	    }
 	}
+	if (ret)
+	    break;
     }
-    return(NULL);
+    for (i = 0;i < ns1->nodeNr;i++)
+	if (values1[i] != NULL)
+	    xmlFree(values1[i]);
+    for (j = 0;j < ns2->nodeNr;j++)
+	if (values2[j] != NULL)
+	    xmlFree(values2[j]);
+    xmlFree(values1);
+    xmlFree(values2);
+    xmlFree(hashs1);
+    xmlFree(hashs2);
+    return(ret);
 }
 
-/**
- * Traversal function for the "ancestor" direction
- * the ancestor axis contains the ancestors of the context node; the ancestors
- * of the context node consist of the parent of context node and the parent's
- * parent and so on; the nodes are ordered in reverse document order; thus the
- * parent is the first node on the axis, and the parent's parent is the second
- * node on the axis
- *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-xmlNode *
-xmlXPathNextAncestor(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+static int
+xmlXPathEqualValuesCommon(xmlXPathParserContextPtr ctxt,
+  xmlXPathObjectPtr arg1, xmlXPathObjectPtr arg2) {
+    int ret = 0;
     /*
-     * the parent of an attribute or namespace node is the element
-     * to which the attribute or namespace node is attached
-     * !!!!!!!!!!!!!
+     *At this point we are assured neither arg1 nor arg2
+     *is a nodeset, so we can just pick the appropriate routine.
      */
-    if (cur == NULL) {
-	if (ctxt->context->node == NULL) return(NULL);
-	switch (ctxt->context->node->type) {
-            case XML_ELEMENT_NODE:
-            case XML_TEXT_NODE:
-            case XML_CDATA_SECTION_NODE:
-            case XML_ENTITY_REF_NODE:
-            case XML_ENTITY_NODE:
-            case XML_PI_NODE:
-            case XML_COMMENT_NODE:
-	    case XML_DTD_NODE:
-	    case XML_ELEMENT_DECL:
-	    case XML_ATTRIBUTE_DECL:
-	    case XML_ENTITY_DECL:
-            case XML_NOTATION_NODE:
-	    case XML_XINCLUDE_START:
-	    case XML_XINCLUDE_END:
-		if (ctxt->context->node->parent == NULL)
-		    return((xmlNodePtr) ctxt->context->doc);
-		if ((ctxt->context->node->parent->type == XML_ELEMENT_NODE) &&
-		    ((ctxt->context->node->parent->name[0] == ' ') ||
-		     (xmlStrEqual(ctxt->context->node->parent->name,
-				 BAD_CAST "fake node libxslt"))))
-		    return(NULL);
-		return(ctxt->context->node->parent);
-            case XML_ATTRIBUTE_NODE: {
-		xmlAttrPtr tmp = (xmlAttrPtr) ctxt->context->node;
-
-		return(tmp->parent);
-	    }
-            case XML_DOCUMENT_NODE:
-            case XML_DOCUMENT_TYPE_NODE:
-            case XML_DOCUMENT_FRAG_NODE:
-            case XML_HTML_DOCUMENT_NODE:
-                return(NULL);
-	    case XML_NAMESPACE_DECL: {
-		xmlNsPtr ns = (xmlNsPtr) ctxt->context->node;
-
-		if ((ns->next != NULL) &&
-		    (ns->next->type != XML_NAMESPACE_DECL))
-		    return((xmlNodePtr) ns->next);
-		/* Bad, how did that namespace end up here ? */
-                return(NULL);
+    switch (arg1->type) {
+        case XPATH_UNDEFINED:
+	    break;
+        case XPATH_BOOLEAN:
+	    switch (arg2->type) {
+	        case XPATH_UNDEFINED:
+		    break;
+		case XPATH_BOOLEAN:
+		    ret = (arg1->boolval == arg2->boolval);
+		    break;
+		case XPATH_NUMBER:
+		    ret = (arg1->boolval ==
+			   xmlXPathCastNumberToBoolean(arg2->floatval));
+		    break;
+		case XPATH_STRING:
+		    if ((arg2->stringval == NULL) ||
+			(arg2->stringval[0] == 0)) ret = 0;
+		    else
+			ret = 1;
+		    ret = (arg1->boolval == ret);
+		    break;
+		case XPATH_USERS:
+		    /* TODO */
+		    break;
+		case XPATH_NODESET:
+		case XPATH_XSLT_TREE:
+		    break;
 	    }
-	}
-	return(NULL);
-    }
-    if (cur == ctxt->context->doc->children)
-	return((xmlNodePtr) ctxt->context->doc);
-    if (cur == (xmlNodePtr) ctxt->context->doc)
-	return(NULL);
-    switch (cur->type) {
-	case XML_ELEMENT_NODE:
-	case XML_TEXT_NODE:
-	case XML_CDATA_SECTION_NODE:
-	case XML_ENTITY_REF_NODE:
-	case XML_ENTITY_NODE:
-	case XML_PI_NODE:
-	case XML_COMMENT_NODE:
-	case XML_NOTATION_NODE:
-	case XML_DTD_NODE:
-        case XML_ELEMENT_DECL:
-        case XML_ATTRIBUTE_DECL:
-        case XML_ENTITY_DECL:
-	case XML_XINCLUDE_START:
-	case XML_XINCLUDE_END:
-	    if (cur->parent == NULL)
-		return(NULL);
-	    if ((cur->parent->type == XML_ELEMENT_NODE) &&
-		((cur->parent->name[0] == ' ') ||
-		 (xmlStrEqual(cur->parent->name,
-			      BAD_CAST "fake node libxslt"))))
-		return(NULL);
-	    return(cur->parent);
-	case XML_ATTRIBUTE_NODE: {
-	    xmlAttrPtr att = (xmlAttrPtr) cur;
-
-	    return(att->parent);
-	}
-	case XML_NAMESPACE_DECL: {
-	    xmlNsPtr ns = (xmlNsPtr) cur;
-
-	    if ((ns->next != NULL) &&
-	        (ns->next->type != XML_NAMESPACE_DECL))
-	        return((xmlNodePtr) ns->next);
-	    /* Bad, how did that namespace end up here ? */
-            return(NULL);
-	}
-	case XML_DOCUMENT_NODE:
-	case XML_DOCUMENT_TYPE_NODE:
-	case XML_DOCUMENT_FRAG_NODE:
-	case XML_HTML_DOCUMENT_NODE:
-	    return(NULL);
+	    break;
+        case XPATH_NUMBER:
+	    switch (arg2->type) {
+	        case XPATH_UNDEFINED:
+		    break;
+		case XPATH_BOOLEAN:
+		    ret = (arg2->boolval==
+			   xmlXPathCastNumberToBoolean(arg1->floatval));
+		    break;
+		case XPATH_STRING:
+		    xmlXPathValuePush(ctxt, arg2);
+		    xmlXPathNumberFunction(ctxt, 1);
+		    arg2 = xmlXPathValuePop(ctxt);
+                    if (ctxt->error)
+                        break;
+                    /* Falls through. */
+		case XPATH_NUMBER:
+		    /* Hand check NaN and Infinity equalities */
+		    if (xmlXPathIsNaN(arg1->floatval) ||
+			    xmlXPathIsNaN(arg2->floatval)) {
+		        ret = 0;
+		    } else if (xmlXPathIsInf(arg1->floatval) == 1) {
+		        if (xmlXPathIsInf(arg2->floatval) == 1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else if (xmlXPathIsInf(arg1->floatval) == -1) {
+			if (xmlXPathIsInf(arg2->floatval) == -1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else if (xmlXPathIsInf(arg2->floatval) == 1) {
+			if (xmlXPathIsInf(arg1->floatval) == 1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else if (xmlXPathIsInf(arg2->floatval) == -1) {
+			if (xmlXPathIsInf(arg1->floatval) == -1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else {
+		        ret = (arg1->floatval == arg2->floatval);
+		    }
+		    break;
+		case XPATH_USERS:
+		    /* TODO */
+		    break;
+		case XPATH_NODESET:
+		case XPATH_XSLT_TREE:
+		    break;
+	    }
+	    break;
+        case XPATH_STRING:
+	    switch (arg2->type) {
+	        case XPATH_UNDEFINED:
+		    break;
+		case XPATH_BOOLEAN:
+		    if ((arg1->stringval == NULL) ||
+			(arg1->stringval[0] == 0)) ret = 0;
+		    else
+			ret = 1;
+		    ret = (arg2->boolval == ret);
+		    break;
+		case XPATH_STRING:
+		    ret = xmlStrEqual(arg1->stringval, arg2->stringval);
+		    break;
+		case XPATH_NUMBER:
+		    xmlXPathValuePush(ctxt, arg1);
+		    xmlXPathNumberFunction(ctxt, 1);
+		    arg1 = xmlXPathValuePop(ctxt);
+                    if (ctxt->error)
+                        break;
+		    /* Hand check NaN and Infinity equalities */
+		    if (xmlXPathIsNaN(arg1->floatval) ||
+			    xmlXPathIsNaN(arg2->floatval)) {
+		        ret = 0;
+		    } else if (xmlXPathIsInf(arg1->floatval) == 1) {
+			if (xmlXPathIsInf(arg2->floatval) == 1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else if (xmlXPathIsInf(arg1->floatval) == -1) {
+			if (xmlXPathIsInf(arg2->floatval) == -1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else if (xmlXPathIsInf(arg2->floatval) == 1) {
+			if (xmlXPathIsInf(arg1->floatval) == 1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else if (xmlXPathIsInf(arg2->floatval) == -1) {
+			if (xmlXPathIsInf(arg1->floatval) == -1)
+			    ret = 1;
+			else
+			    ret = 0;
+		    } else {
+		        ret = (arg1->floatval == arg2->floatval);
+		    }
+		    break;
+		case XPATH_USERS:
+		    /* TODO */
+		    break;
+		case XPATH_NODESET:
+		case XPATH_XSLT_TREE:
+		    break;
+	    }
+	    break;
+        case XPATH_USERS:
+	    /* TODO */
+	    break;
+	case XPATH_NODESET:
+	case XPATH_XSLT_TREE:
+	    break;
     }
-    return(NULL);
-}
-
-/**
- * Traversal function for the "ancestor-or-self" direction
- * he ancestor-or-self axis contains the context node and ancestors of
- * the context node in reverse document order; thus the context node is
- * the first node on the axis, and the context node's parent the second;
- * parent here is defined the same as with the parent axis.
- *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-xmlNode *
-xmlXPathNextAncestorOrSelf(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL)
-        return(ctxt->context->node);
-    return(xmlXPathNextAncestor(ctxt, cur));
+    xmlXPathReleaseObject(ctxt->context, arg1);
+    xmlXPathReleaseObject(ctxt->context, arg2);
+    return(ret);
 }
 
 /**
- * Traversal function for the "following-sibling" direction
- * The following-sibling axis contains the following siblings of the context
- * node in document order.
+ * Implement the equal operation on XPath objects content: `arg1` == `arg2`
  *
  * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
+ * @returns 0 or 1 depending on the results of the test.
  */
-xmlNode *
-xmlXPathNextFollowingSibling(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
-	(ctxt->context->node->type == XML_NAMESPACE_DECL))
-	return(NULL);
-    if (cur == (xmlNodePtr) ctxt->context->doc)
-        return(NULL);
-    if (cur == NULL)
-        return(ctxt->context->node->next);
-    return(cur->next);
-}
+int
+xmlXPathEqualValues(xmlXPathParserContext *ctxt) {
+    xmlXPathObjectPtr arg1, arg2, argtmp;
+    int ret = 0;
 
-/**
- * Traversal function for the "preceding-sibling" direction
- * The preceding-sibling axis contains the preceding siblings of the context
- * node in reverse document order; the first preceding sibling is first on the
- * axis; the sibling preceding that node is the second on the axis and so on.
- *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-xmlNode *
-xmlXPathNextPrecedingSibling(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
-	(ctxt->context->node->type == XML_NAMESPACE_DECL))
-	return(NULL);
-    if (cur == (xmlNodePtr) ctxt->context->doc)
-        return(NULL);
-    if (cur == NULL)
-        return(ctxt->context->node->prev);
-    if ((cur->prev != NULL) && (cur->prev->type == XML_DTD_NODE)) {
-	cur = cur->prev;
-	if (cur == NULL)
-	    return(ctxt->context->node->prev);
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(0);
+    arg2 = xmlXPathValuePop(ctxt);
+    arg1 = xmlXPathValuePop(ctxt);
+    if ((arg1 == NULL) || (arg2 == NULL)) {
+	if (arg1 != NULL)
+	    xmlXPathReleaseObject(ctxt->context, arg1);
+	else
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+	XP_ERROR0(XPATH_INVALID_OPERAND);
     }
-    return(cur->prev);
+
+    if (arg1 == arg2) {
+	xmlXPathFreeObject(arg1);
+        return(1);
+    }
+
+    /*
+     *If either argument is a nodeset, it's a 'special case'
+     */
+    if ((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE) ||
+      (arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
+	/*
+	 *Hack it to assure arg1 is the nodeset
+	 */
+	if ((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE)) {
+		argtmp = arg2;
+		arg2 = arg1;
+		arg1 = argtmp;
+	}
+	switch (arg2->type) {
+	    case XPATH_UNDEFINED:
+		break;
+	    case XPATH_NODESET:
+	    case XPATH_XSLT_TREE:
+		ret = xmlXPathEqualNodeSets(ctxt, arg1, arg2, 0);
+		break;
+	    case XPATH_BOOLEAN:
+		if ((arg1->nodesetval == NULL) ||
+		  (arg1->nodesetval->nodeNr == 0)) ret = 0;
+		else
+		    ret = 1;
+		ret = (ret == arg2->boolval);
+		break;
+	    case XPATH_NUMBER:
+		ret = xmlXPathEqualNodeSetFloat(ctxt, arg1, arg2->floatval, 0);
+		break;
+	    case XPATH_STRING:
+		ret = xmlXPathEqualNodeSetString(ctxt, arg1,
+                                                 arg2->stringval, 0);
+		break;
+	    case XPATH_USERS:
+		/* TODO */
+		break;
+	}
+	xmlXPathReleaseObject(ctxt->context, arg1);
+	xmlXPathReleaseObject(ctxt->context, arg2);
+	return(ret);
+    }
+
+    return (xmlXPathEqualValuesCommon(ctxt, arg1, arg2));
 }
 
 /**
- * Traversal function for the "following" direction
- * The following axis contains all nodes in the same document as the context
- * node that are after the context node in document order, excluding any
- * descendants and excluding attribute nodes and namespace nodes; the nodes
- * are ordered in document order
+ * Implement the equal operation on XPath objects content: `arg1` == `arg2`
  *
  * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
+ * @returns 0 or 1 depending on the results of the test.
  */
-xmlNode *
-xmlXPathNextFollowing(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if ((cur != NULL) && (cur->type  != XML_ATTRIBUTE_NODE) &&
-        (cur->type != XML_NAMESPACE_DECL) && (cur->children != NULL))
-        return(cur->children);
-
-    if (cur == NULL) {
-        cur = ctxt->context->node;
-        if (cur->type == XML_ATTRIBUTE_NODE) {
-            cur = cur->parent;
-        } else if (cur->type == XML_NAMESPACE_DECL) {
-            xmlNsPtr ns = (xmlNsPtr) cur;
+int
+xmlXPathNotEqualValues(xmlXPathParserContext *ctxt) {
+    xmlXPathObjectPtr arg1, arg2, argtmp;
+    int ret = 0;
 
-            if ((ns->next == NULL) ||
-                (ns->next->type == XML_NAMESPACE_DECL))
-                return (NULL);
-            cur = (xmlNodePtr) ns->next;
-        }
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(0);
+    arg2 = xmlXPathValuePop(ctxt);
+    arg1 = xmlXPathValuePop(ctxt);
+    if ((arg1 == NULL) || (arg2 == NULL)) {
+	if (arg1 != NULL)
+	    xmlXPathReleaseObject(ctxt->context, arg1);
+	else
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+	XP_ERROR0(XPATH_INVALID_OPERAND);
     }
-    if (cur == NULL) return(NULL) ; /* ERROR */
-    if (cur->next != NULL) return(cur->next) ;
-    do {
-        cur = cur->parent;
-        if (cur == NULL) break;
-        if (cur == (xmlNodePtr) ctxt->context->doc) return(NULL);
-        if (cur->next != NULL) return(cur->next);
-    } while (cur != NULL);
-    return(cur);
-}
 
-/*
- * @param ancestor  the ancestor node
- * @param node  the current node
- *
- * Check that `ancestor` is a `node`'s ancestor
- *
- * @returns 1 if `ancestor` is a `node`'s ancestor, 0 otherwise.
- */
-static int
-xmlXPathIsAncestor(xmlNodePtr ancestor, xmlNodePtr node) {
-    if ((ancestor == NULL) || (node == NULL)) return(0);
-    if (node->type == XML_NAMESPACE_DECL)
-        return(0);
-    if (ancestor->type == XML_NAMESPACE_DECL)
+    if (arg1 == arg2) {
+	xmlXPathReleaseObject(ctxt->context, arg1);
         return(0);
-    /* nodes need to be in the same document */
-    if (ancestor->doc != node->doc) return(0);
-    /* avoid searching if ancestor or node is the root node */
-    if (ancestor == (xmlNodePtr) node->doc) return(1);
-    if (node == (xmlNodePtr) ancestor->doc) return(0);
-    while (node->parent != NULL) {
-        if (node->parent == ancestor)
-            return(1);
-	node = node->parent;
     }
-    return(0);
+
+    /*
+     *If either argument is a nodeset, it's a 'special case'
+     */
+    if ((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE) ||
+      (arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
+	/*
+	 *Hack it to assure arg1 is the nodeset
+	 */
+	if ((arg1->type != XPATH_NODESET) && (arg1->type != XPATH_XSLT_TREE)) {
+		argtmp = arg2;
+		arg2 = arg1;
+		arg1 = argtmp;
+	}
+	switch (arg2->type) {
+	    case XPATH_UNDEFINED:
+		break;
+	    case XPATH_NODESET:
+	    case XPATH_XSLT_TREE:
+		ret = xmlXPathEqualNodeSets(ctxt, arg1, arg2, 1);
+		break;
+	    case XPATH_BOOLEAN:
+		if ((arg1->nodesetval == NULL) ||
+		  (arg1->nodesetval->nodeNr == 0)) ret = 0;
+		else
+		    ret = 1;
+		ret = (ret != arg2->boolval);
+		break;
+	    case XPATH_NUMBER:
+		ret = xmlXPathEqualNodeSetFloat(ctxt, arg1, arg2->floatval, 1);
+		break;
+	    case XPATH_STRING:
+		ret = xmlXPathEqualNodeSetString(ctxt, arg1,
+                                                 arg2->stringval, 1);
+		break;
+	    case XPATH_USERS:
+		/* TODO */
+		break;
+	}
+	xmlXPathReleaseObject(ctxt->context, arg1);
+	xmlXPathReleaseObject(ctxt->context, arg2);
+	return(ret);
+    }
+
+    return (!xmlXPathEqualValuesCommon(ctxt, arg1, arg2));
 }
 
 /**
- * Traversal function for the "preceding" direction
- * the preceding axis contains all nodes in the same document as the context
- * node that are before the context node in document order, excluding any
- * ancestors and excluding attribute nodes and namespace nodes; the nodes are
- * ordered in reverse document order
+ * Implement the compare operation on XPath objects:
+ *     `arg1` < `arg2`    (1, 1, ...
+ *     `arg1` <= `arg2`   (1, 0, ...
+ *     `arg1` > `arg2`    (0, 1, ...
+ *     `arg1` >= `arg2`   (0, 0, ...
+ *
+ * When neither object to be compared is a node-set and the operator is
+ * <=, <, >=, >, then the objects are compared by converted both objects
+ * to numbers and comparing the numbers according to IEEE 754. The <
+ * comparison will be true if and only if the first number is less than the
+ * second number. The <= comparison will be true if and only if the first
+ * number is less than or equal to the second number. The > comparison
+ * will be true if and only if the first number is greater than the second
+ * number. The >= comparison will be true if and only if the first number
+ * is greater than or equal to the second number.
  *
  * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
+ * @param inf  less than (1) or greater than (0)
+ * @param strict  is the comparison strict
+ * @returns 1 if the comparison succeeded, 0 if it failed
  */
-xmlNode *
-xmlXPathNextPreceding(xmlXPathParserContext *ctxt, xmlNode *cur)
-{
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL) {
-        cur = ctxt->context->node;
-        if (cur->type == XML_ATTRIBUTE_NODE) {
-            cur = cur->parent;
-        } else if (cur->type == XML_NAMESPACE_DECL) {
-            xmlNsPtr ns = (xmlNsPtr) cur;
+int
+xmlXPathCompareValues(xmlXPathParserContext *ctxt, int inf, int strict) {
+    int ret = 0, arg1i = 0, arg2i = 0;
+    xmlXPathObjectPtr arg1, arg2;
 
-            if ((ns->next == NULL) ||
-                (ns->next->type == XML_NAMESPACE_DECL))
-                return (NULL);
-            cur = (xmlNodePtr) ns->next;
-        }
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(0);
+    arg2 = xmlXPathValuePop(ctxt);
+    arg1 = xmlXPathValuePop(ctxt);
+    if ((arg1 == NULL) || (arg2 == NULL)) {
+	if (arg1 != NULL)
+	    xmlXPathReleaseObject(ctxt->context, arg1);
+	else
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+	XP_ERROR0(XPATH_INVALID_OPERAND);
     }
-    if ((cur == NULL) || (cur->type == XML_NAMESPACE_DECL))
-	return (NULL);
-    if ((cur->prev != NULL) && (cur->prev->type == XML_DTD_NODE))
-	cur = cur->prev;
-    do {
-        if (cur->prev != NULL) {
-            for (cur = cur->prev; cur->last != NULL; cur = cur->last) ;
-            return (cur);
-        }
-
-        cur = cur->parent;
-        if (cur == NULL)
-            return (NULL);
-        if (cur == ctxt->context->doc->children)
-            return (NULL);
-    } while (xmlXPathIsAncestor(cur, ctxt->context->node));
-    return (cur);
-}
 
-/**
- * Traversal function for the "preceding" direction
- * the preceding axis contains all nodes in the same document as the context
- * node that are before the context node in document order, excluding any
- * ancestors and excluding attribute nodes and namespace nodes; the nodes are
- * ordered in reverse document order
- * This is a faster implementation but internal only since it requires a
- * state kept in the parser context: ctxt->ancestor.
- *
- * @param ctxt  the XPath Parser context
- * @param cur  the current node in the traversal
- * @returns the next element following that axis
- */
-static xmlNodePtr
-xmlXPathNextPrecedingInternal(xmlXPathParserContextPtr ctxt,
-                              xmlNodePtr cur)
-{
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (cur == NULL) {
-        cur = ctxt->context->node;
-        if (cur == NULL)
-            return (NULL);
-        if (cur->type == XML_ATTRIBUTE_NODE) {
-            cur = cur->parent;
-        } else if (cur->type == XML_NAMESPACE_DECL) {
-            xmlNsPtr ns = (xmlNsPtr) cur;
+    if ((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE) ||
+      (arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
+	/*
+	 * If either argument is a XPATH_NODESET or XPATH_XSLT_TREE the two arguments
+	 * are not freed from within this routine; they will be freed from the
+	 * called routine, e.g. xmlXPathCompareNodeSets or xmlXPathCompareNodeSetValue
+	 */
+	if (((arg2->type == XPATH_NODESET) || (arg2->type == XPATH_XSLT_TREE)) &&
+	  ((arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE))){
+	    ret = xmlXPathCompareNodeSets(ctxt, inf, strict, arg1, arg2);
+	} else {
+	    if ((arg1->type == XPATH_NODESET) || (arg1->type == XPATH_XSLT_TREE)) {
+		ret = xmlXPathCompareNodeSetValue(ctxt, inf, strict,
+			                          arg1, arg2);
+	    } else {
+		ret = xmlXPathCompareNodeSetValue(ctxt, !inf, strict,
+			                          arg2, arg1);
+	    }
+	}
+	return(ret);
+    }
 
-            if ((ns->next == NULL) ||
-                (ns->next->type == XML_NAMESPACE_DECL))
-                return (NULL);
-            cur = (xmlNodePtr) ns->next;
-        }
-        ctxt->ancestor = cur->parent;
+    if (arg1->type != XPATH_NUMBER) {
+	xmlXPathValuePush(ctxt, arg1);
+	xmlXPathNumberFunction(ctxt, 1);
+	arg1 = xmlXPathValuePop(ctxt);
     }
-    if (cur->type == XML_NAMESPACE_DECL)
-        return(NULL);
-    if ((cur->prev != NULL) && (cur->prev->type == XML_DTD_NODE))
-	cur = cur->prev;
-    while (cur->prev == NULL) {
-        cur = cur->parent;
-        if (cur == NULL)
-            return (NULL);
-        if (cur == ctxt->context->doc->children)
-            return (NULL);
-        if (cur != ctxt->ancestor)
-            return (cur);
-        ctxt->ancestor = cur->parent;
+    if (arg2->type != XPATH_NUMBER) {
+	xmlXPathValuePush(ctxt, arg2);
+	xmlXPathNumberFunction(ctxt, 1);
+	arg2 = xmlXPathValuePop(ctxt);
     }
-    cur = cur->prev;
-    while (cur->last != NULL)
-        cur = cur->last;
-    return (cur);
+    if (ctxt->error)
+        goto error;
+    /*
+     * Add tests for infinity and nan
+     * => feedback on 3.4 for Inf and NaN
+     */
+    /* Hand check NaN and Infinity comparisons */
+    if (xmlXPathIsNaN(arg1->floatval) || xmlXPathIsNaN(arg2->floatval)) {
+	ret=0;
+    } else {
+	arg1i=xmlXPathIsInf(arg1->floatval);
+	arg2i=xmlXPathIsInf(arg2->floatval);
+	if (inf && strict) {
+	    if ((arg1i == -1 && arg2i != -1) ||
+		(arg2i == 1 && arg1i != 1)) {
+		ret = 1;
+	    } else if (arg1i == 0 && arg2i == 0) {
+		ret = (arg1->floatval < arg2->floatval);
+	    } else {
+		ret = 0;
+	    }
+	}
+	else if (inf && !strict) {
+	    if (arg1i == -1 || arg2i == 1) {
+		ret = 1;
+	    } else if (arg1i == 0 && arg2i == 0) {
+		ret = (arg1->floatval <= arg2->floatval);
+	    } else {
+		ret = 0;
+	    }
+	}
+	else if (!inf && strict) {
+	    if ((arg1i == 1 && arg2i != 1) ||
+		(arg2i == -1 && arg1i != -1)) {
+		ret = 1;
+	    } else if (arg1i == 0 && arg2i == 0) {
+		ret = (arg1->floatval > arg2->floatval);
+	    } else {
+		ret = 0;
+	    }
+	}
+	else if (!inf && !strict) {
+	    if (arg1i == 1 || arg2i == -1) {
+		ret = 1;
+	    } else if (arg1i == 0 && arg2i == 0) {
+		ret = (arg1->floatval >= arg2->floatval);
+	    } else {
+		ret = 0;
+	    }
+	}
+    }
+error:
+    xmlXPathReleaseObject(ctxt->context, arg1);
+    xmlXPathReleaseObject(ctxt->context, arg2);
+    return(ret);
 }
 
 /**
- * Traversal function for the "namespace" direction
- * the namespace axis contains the namespace nodes of the context node;
- * the order of nodes on this axis is implementation-defined; the axis will
- * be empty unless the context node is an element
- *
- * We keep the XML namespace node at the end of the list.
+ * Implement the unary - operation on an XPath object
+ * The numeric operators convert their operands to numbers as if
+ * by calling the number function.
  *
  * @param ctxt  the XPath Parser context
- * @param cur  the current attribute in the traversal
- * @returns the next element following that axis
  */
-xmlNode *
-xmlXPathNextNamespace(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (ctxt->context->node->type != XML_ELEMENT_NODE) return(NULL);
-    if (cur == NULL) {
-        if (ctxt->context->tmpNsList != NULL)
-	    xmlFree(ctxt->context->tmpNsList);
-	ctxt->context->tmpNsNr = 0;
-        if (xmlGetNsListSafe(ctxt->context->doc, ctxt->context->node,
-                             &ctxt->context->tmpNsList) < 0) {
-            xmlXPathPErrMemory(ctxt);
-            return(NULL);
-        }
-        if (ctxt->context->tmpNsList != NULL) {
-            while (ctxt->context->tmpNsList[ctxt->context->tmpNsNr] != NULL) {
-                ctxt->context->tmpNsNr++;
-            }
-        }
-	return((xmlNodePtr) xmlXPathXMLNamespace);
-    }
-    if (ctxt->context->tmpNsNr > 0) {
-	return (xmlNodePtr)ctxt->context->tmpNsList[--ctxt->context->tmpNsNr];
-    } else {
-	if (ctxt->context->tmpNsList != NULL)
-	    xmlFree(ctxt->context->tmpNsList);
-	ctxt->context->tmpNsList = NULL;
-	return(NULL);
-    }
+void
+xmlXPathValueFlipSign(xmlXPathParserContext *ctxt) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return;
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+    ctxt->value->floatval = -ctxt->value->floatval;
 }
 
 /**
- * Traversal function for the "attribute" direction
- * TODO: support DTD inherited default attributes
+ * Implement the add operation on XPath objects:
+ * The numeric operators convert their operands to numbers as if
+ * by calling the number function.
  *
  * @param ctxt  the XPath Parser context
- * @param cur  the current attribute in the traversal
- * @returns the next element following that axis
  */
-xmlNode *
-xmlXPathNextAttribute(xmlXPathParserContext *ctxt, xmlNode *cur) {
-    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
-    if (ctxt->context->node == NULL)
-	return(NULL);
-    if (ctxt->context->node->type != XML_ELEMENT_NODE)
-	return(NULL);
-    if (cur == NULL) {
-        if (ctxt->context->node == (xmlNodePtr) ctxt->context->doc)
-	    return(NULL);
-        return((xmlNodePtr)ctxt->context->node->properties);
-    }
-    return((xmlNodePtr)cur->next);
-}
-
-/************************************************************************
- *									*
- *		NodeTest Functions					*
- *									*
- ************************************************************************/
-
-#define IS_FUNCTION			200
-
+void
+xmlXPathAddValues(xmlXPathParserContext *ctxt) {
+    xmlXPathObjectPtr arg;
+    double val;
 
-/************************************************************************
- *									*
- *		Implicit tree core function library			*
- *									*
- ************************************************************************/
+    arg = xmlXPathValuePop(ctxt);
+    if (arg == NULL)
+	XP_ERROR(XPATH_INVALID_OPERAND);
+    val = xmlXPathCastToNumberInternal(ctxt, arg);
+    xmlXPathReleaseObject(ctxt->context, arg);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+    ctxt->value->floatval += val;
+}
 
 /**
- * Initialize the context to the root of the document
+ * Implement the subtraction operation on XPath objects:
+ * The numeric operators convert their operands to numbers as if
+ * by calling the number function.
  *
  * @param ctxt  the XPath Parser context
  */
 void
-xmlXPathRoot(xmlXPathParserContext *ctxt) {
-    if ((ctxt == NULL) || (ctxt->context == NULL))
-	return;
-    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
-                                            (xmlNodePtr) ctxt->context->doc));
-}
-
-/************************************************************************
- *									*
- *		The explicit core function library			*
- *http://www.w3.org/Style/XSL/Group/1999/07/xpath-19990705.html#corelib	*
- *									*
- ************************************************************************/
+xmlXPathSubValues(xmlXPathParserContext *ctxt) {
+    xmlXPathObjectPtr arg;
+    double val;
 
+    arg = xmlXPathValuePop(ctxt);
+    if (arg == NULL)
+	XP_ERROR(XPATH_INVALID_OPERAND);
+    val = xmlXPathCastToNumberInternal(ctxt, arg);
+    xmlXPathReleaseObject(ctxt->context, arg);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+    ctxt->value->floatval -= val;
+}
 
 /**
- * Implement the last() XPath function
- *    number last()
- * The last function returns the number of nodes in the context node list.
+ * Implement the multiply operation on XPath objects:
+ * The numeric operators convert their operands to numbers as if
+ * by calling the number function.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
  */
 void
-xmlXPathLastFunction(xmlXPathParserContext *ctxt, int nargs) {
-    CHECK_ARITY(0);
-    if (ctxt->context->contextSize >= 0) {
-	xmlXPathValuePush(ctxt,
-	    xmlXPathCacheNewFloat(ctxt, (double) ctxt->context->contextSize));
-    } else {
-	XP_ERROR(XPATH_INVALID_CTXT_SIZE);
-    }
+xmlXPathMultValues(xmlXPathParserContext *ctxt) {
+    xmlXPathObjectPtr arg;
+    double val;
+
+    arg = xmlXPathValuePop(ctxt);
+    if (arg == NULL)
+	XP_ERROR(XPATH_INVALID_OPERAND);
+    val = xmlXPathCastToNumberInternal(ctxt, arg);
+    xmlXPathReleaseObject(ctxt->context, arg);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+    ctxt->value->floatval *= val;
 }
 
 /**
- * Implement the position() XPath function
- *    number position()
- * The position function returns the position of the context node in the
- * context node list. The first position is 1, and so the last position
- * will be equal to last().
+ * Implement the div operation on XPath objects `arg1` / `arg2`.
+ * The numeric operators convert their operands to numbers as if
+ * by calling the number function.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
  */
+ATTRIBUTE_NO_SANITIZE("float-divide-by-zero")
 void
-xmlXPathPositionFunction(xmlXPathParserContext *ctxt, int nargs) {
-    CHECK_ARITY(0);
-    if (ctxt->context->proximityPosition >= 0) {
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
-            (double) ctxt->context->proximityPosition));
-    } else {
-	XP_ERROR(XPATH_INVALID_CTXT_POSITION);
-    }
+xmlXPathDivValues(xmlXPathParserContext *ctxt) {
+    xmlXPathObjectPtr arg;
+    double val;
+
+    arg = xmlXPathValuePop(ctxt);
+    if (arg == NULL)
+	XP_ERROR(XPATH_INVALID_OPERAND);
+    val = xmlXPathCastToNumberInternal(ctxt, arg);
+    xmlXPathReleaseObject(ctxt->context, arg);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+    ctxt->value->floatval /= val;
 }
 
 /**
- * Implement the count() XPath function
- *    number count(node-set)
+ * Implement the mod operation on XPath objects: `arg1` / `arg2`
+ * The numeric operators convert their operands to numbers as if
+ * by calling the number function.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
  */
 void
-xmlXPathCountFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
-
-    CHECK_ARITY(1);
-    if ((ctxt->value == NULL) ||
-	((ctxt->value->type != XPATH_NODESET) &&
-	 (ctxt->value->type != XPATH_XSLT_TREE)))
-	XP_ERROR(XPATH_INVALID_TYPE);
-    cur = xmlXPathValuePop(ctxt);
+xmlXPathModValues(xmlXPathParserContext *ctxt) {
+    xmlXPathObjectPtr arg;
+    double arg1, arg2;
 
-    if ((cur == NULL) || (cur->nodesetval == NULL))
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, 0.0));
-    else
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
-	    (double) cur->nodesetval->nodeNr));
-    xmlXPathReleaseObject(ctxt->context, cur);
+    arg = xmlXPathValuePop(ctxt);
+    if (arg == NULL)
+	XP_ERROR(XPATH_INVALID_OPERAND);
+    arg2 = xmlXPathCastToNumberInternal(ctxt, arg);
+    xmlXPathReleaseObject(ctxt->context, arg);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+    arg1 = ctxt->value->floatval;
+    if (arg2 == 0)
+	ctxt->value->floatval = xmlXPathNAN;
+    else {
+	ctxt->value->floatval = fmod(arg1, arg2);
+    }
 }
 
-/**
- * Selects elements by their unique ID.
- *
- * @param doc  the document
- * @param ids  a whitespace separated list of IDs
- * @returns a node-set of selected elements.
+/************************************************************************
+ *									*
+ *		The traversal functions					*
+ *									*
+ ************************************************************************/
+
+/*
+ * A traversal function enumerates nodes along an axis.
+ * Initially it must be called with NULL, and it indicates
+ * termination on the axis by returning NULL.
  */
-static xmlNodeSetPtr
-xmlXPathGetElementsByIds (xmlDocPtr doc, const xmlChar *ids) {
-    xmlNodeSetPtr ret;
-    const xmlChar *cur = ids;
-    xmlChar *ID;
-    xmlAttrPtr attr;
-    xmlNodePtr elem = NULL;
+typedef xmlNode *(*xmlXPathTraversalFunction)
+                    (xmlXPathParserContext *ctxt, xmlNode *cur);
 
-    if (ids == NULL) return(NULL);
+/*
+ * A traversal function enumerates nodes along an axis.
+ * Initially it must be called with NULL, and it indicates
+ * termination on the axis by returning NULL.
+ * The context node of the traversal is specified via `contextNode`.
+ */
+typedef xmlNode *(*xmlXPathTraversalFunctionExt)
+                    (xmlNode *cur, xmlNode *contextNode);
 
-    ret = xmlXPathNodeSetCreate(NULL);
-    if (ret == NULL)
-        return(ret);
+/*
+ * Used for merging node sets in #xmlXPathCollectAndTest.
+ */
+typedef xmlNodeSet *(*xmlXPathNodeSetMergeFunction)
+		    (xmlNodeSet *, xmlNodeSet *);
 
-    while (IS_BLANK_CH(*cur)) cur++;
-    while (*cur != 0) {
-	while ((!IS_BLANK_CH(*cur)) && (*cur != 0))
-	    cur++;
 
-        ID = xmlStrndup(ids, cur - ids);
-	if (ID == NULL) {
-            xmlXPathFreeNodeSet(ret);
-            return(NULL);
-        }
-        /*
-         * We used to check the fact that the value passed
-         * was an NCName, but this generated much troubles for
-         * me and Aleksey Sanin, people blatantly violated that
-         * constraint, like Visa3D spec.
-         * if (xmlValidateNCName(ID, 1) == 0)
-         */
-        attr = xmlGetID(doc, ID);
-        xmlFree(ID);
-        if (attr != NULL) {
-            if (attr->type == XML_ATTRIBUTE_NODE)
-                elem = attr->parent;
-            else if (attr->type == XML_ELEMENT_NODE)
-                elem = (xmlNodePtr) attr;
-            else
-                elem = NULL;
-            if (elem != NULL) {
-                if (xmlXPathNodeSetAdd(ret, elem) < 0) {
-                    xmlXPathFreeNodeSet(ret);
-                    return(NULL);
-                }
-            }
-        }
+/**
+ * Traversal function for the "self" direction
+ * The self axis contains just the context node itself
+ *
+ * @param ctxt  the XPath Parser context
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
+ */
+xmlNode *
+xmlXPathNextSelf(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL)
+        return(ctxt->context->node);
+    return(NULL);
+}
 
-	while (IS_BLANK_CH(*cur)) cur++;
-	ids = cur;
+/**
+ * Traversal function for the "child" direction
+ * The child axis contains the children of the context node in document order.
+ *
+ * @param ctxt  the XPath Parser context
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
+ */
+xmlNode *
+xmlXPathNextChild(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL) {
+	if (ctxt->context->node == NULL) return(NULL);
+	switch (ctxt->context->node->type) {
+            case XML_ELEMENT_NODE:
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+            case XML_ENTITY_REF_NODE:
+            case XML_ENTITY_NODE:
+            case XML_PI_NODE:
+            case XML_COMMENT_NODE:
+            case XML_NOTATION_NODE:
+            case XML_DTD_NODE:
+		return(ctxt->context->node->children);
+            case XML_DOCUMENT_NODE:
+            case XML_DOCUMENT_TYPE_NODE:
+            case XML_DOCUMENT_FRAG_NODE:
+            case XML_HTML_DOCUMENT_NODE:
+		return(((xmlDocPtr) ctxt->context->node)->children);
+	    case XML_ELEMENT_DECL:
+	    case XML_ATTRIBUTE_DECL:
+	    case XML_ENTITY_DECL:
+            case XML_ATTRIBUTE_NODE:
+	    case XML_NAMESPACE_DECL:
+	    case XML_XINCLUDE_START:
+	    case XML_XINCLUDE_END:
+		return(NULL);
+	}
+	return(NULL);
     }
-    return(ret);
+    if ((cur->type == XML_DOCUMENT_NODE) ||
+        (cur->type == XML_HTML_DOCUMENT_NODE))
+	return(NULL);
+    return(cur->next);
 }
 
 /**
- * Implement the id() XPath function
- *    node-set id(object)
- * The id function selects elements by their unique ID
- * (see [5.2.1 Unique IDs]). When the argument to id is of type node-set,
- * then the result is the union of the result of applying id to the
- * string value of each of the nodes in the argument node-set. When the
- * argument to id is of any other type, the argument is converted to a
- * string as if by a call to the string function; the string is split
- * into a whitespace-separated list of tokens (whitespace is any sequence
- * of characters matching the production S); the result is a node-set
- * containing the elements in the same document as the context node that
- * have a unique ID equal to any of the tokens in the list.
+ * Traversal function for the "child" direction and nodes of type element.
+ * The child axis contains the children of the context node in document order.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathIdFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlChar *tokens;
-    xmlNodeSetPtr ret;
-    xmlXPathObjectPtr obj;
-
-    CHECK_ARITY(1);
-    obj = xmlXPathValuePop(ctxt);
-    if (obj == NULL) XP_ERROR(XPATH_INVALID_OPERAND);
-    if ((obj->type == XPATH_NODESET) || (obj->type == XPATH_XSLT_TREE)) {
-	xmlNodeSetPtr ns;
-	int i;
-
-	ret = xmlXPathNodeSetCreate(NULL);
-        if (ret == NULL)
-            xmlXPathPErrMemory(ctxt);
-
-	if (obj->nodesetval != NULL) {
-	    for (i = 0; i < obj->nodesetval->nodeNr; i++) {
-		tokens =
-		    xmlXPathCastNodeToString(obj->nodesetval->nodeTab[i]);
-                if (tokens == NULL)
-                    xmlXPathPErrMemory(ctxt);
-		ns = xmlXPathGetElementsByIds(ctxt->context->doc, tokens);
-                if (ns == NULL)
-                    xmlXPathPErrMemory(ctxt);
-		ret = xmlXPathNodeSetMerge(ret, ns);
-                if (ret == NULL)
-                    xmlXPathPErrMemory(ctxt);
-		xmlXPathFreeNodeSet(ns);
-		if (tokens != NULL)
-		    xmlFree(tokens);
-	    }
+static xmlNodePtr
+xmlXPathNextChildElement(xmlXPathParserContextPtr ctxt, xmlNodePtr cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL) {
+	cur = ctxt->context->node;
+	if (cur == NULL) return(NULL);
+	/*
+	* Get the first element child.
+	*/
+	switch (cur->type) {
+            case XML_ELEMENT_NODE:
+	    case XML_DOCUMENT_FRAG_NODE:
+	    case XML_ENTITY_REF_NODE: /* URGENT TODO: entify-refs as well? */
+            case XML_ENTITY_NODE:
+		cur = cur->children;
+		if (cur != NULL) {
+		    if (cur->type == XML_ELEMENT_NODE)
+			return(cur);
+		    do {
+			cur = cur->next;
+		    } while ((cur != NULL) &&
+			(cur->type != XML_ELEMENT_NODE));
+		    return(cur);
+		}
+		return(NULL);
+            case XML_DOCUMENT_NODE:
+            case XML_HTML_DOCUMENT_NODE:
+		return(xmlDocGetRootElement((xmlDocPtr) cur));
+	    default:
+		return(NULL);
 	}
-	xmlXPathReleaseObject(ctxt->context, obj);
-	xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, ret));
-	return;
+	return(NULL);
     }
-    tokens = xmlXPathCastToString(obj);
-    if (tokens == NULL)
-        xmlXPathPErrMemory(ctxt);
-    xmlXPathReleaseObject(ctxt->context, obj);
-    ret = xmlXPathGetElementsByIds(ctxt->context->doc, tokens);
-    if (ret == NULL)
-        xmlXPathPErrMemory(ctxt);
-    xmlFree(tokens);
-    xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, ret));
+    /*
+    * Get the next sibling element node.
+    */
+    switch (cur->type) {
+	case XML_ELEMENT_NODE:
+	case XML_TEXT_NODE:
+	case XML_ENTITY_REF_NODE:
+	case XML_ENTITY_NODE:
+	case XML_CDATA_SECTION_NODE:
+	case XML_PI_NODE:
+	case XML_COMMENT_NODE:
+	case XML_XINCLUDE_END:
+	    break;
+	/* case XML_DTD_NODE: */ /* URGENT TODO: DTD-node as well? */
+	default:
+	    return(NULL);
+    }
+    if (cur->next != NULL) {
+	if (cur->next->type == XML_ELEMENT_NODE)
+	    return(cur->next);
+	cur = cur->next;
+	do {
+	    cur = cur->next;
+	} while ((cur != NULL) && (cur->type != XML_ELEMENT_NODE));
+	return(cur);
+    }
+    return(NULL);
 }
 
 /**
- * Implement the local-name() XPath function
- *    string local-name(node-set?)
- * The local-name function returns a string containing the local part
- * of the name of the node in the argument node-set that is first in
- * document order. If the node-set is empty or the first node has no
- * name, an empty string is returned. If the argument is omitted it
- * defaults to the context node.
+ * Traversal function for the "descendant" direction
+ * the descendant axis contains the descendants of the context node in document
+ * order; a descendant is a child or a child of a child and so on.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathLocalNameFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
+xmlNode *
+xmlXPathNextDescendant(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL) {
+	if (ctxt->context->node == NULL)
+	    return(NULL);
+	if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
+	    (ctxt->context->node->type == XML_NAMESPACE_DECL))
+	    return(NULL);
 
-    if (ctxt == NULL) return;
+        if (ctxt->context->node == (xmlNodePtr) ctxt->context->doc)
+	    return(ctxt->context->doc->children);
+        return(ctxt->context->node->children);
+    }
 
-    if (nargs == 0) {
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt, ctxt->context->node));
-	nargs = 1;
+    if (cur->type == XML_NAMESPACE_DECL)
+        return(NULL);
+    if (cur->children != NULL) {
+	/*
+	 * Do not descend on entities declarations
+	 */
+	if (cur->children->type != XML_ENTITY_DECL) {
+	    cur = cur->children;
+	    /*
+	     * Skip DTDs
+	     */
+	    if (cur->type != XML_DTD_NODE)
+		return(cur);
+	}
     }
 
-    CHECK_ARITY(1);
-    if ((ctxt->value == NULL) ||
-	((ctxt->value->type != XPATH_NODESET) &&
-	 (ctxt->value->type != XPATH_XSLT_TREE)))
-	XP_ERROR(XPATH_INVALID_TYPE);
-    cur = xmlXPathValuePop(ctxt);
+    if (cur == ctxt->context->node) return(NULL);
 
-    if ((cur->nodesetval == NULL) || (cur->nodesetval->nodeNr == 0)) {
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-    } else {
-	int i = 0; /* Should be first in document order !!!!! */
-	switch (cur->nodesetval->nodeTab[i]->type) {
-	case XML_ELEMENT_NODE:
-	case XML_ATTRIBUTE_NODE:
-	case XML_PI_NODE:
-	    if (cur->nodesetval->nodeTab[i]->name[0] == ' ')
-		xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-	    else
-		xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
-			cur->nodesetval->nodeTab[i]->name));
-	    break;
-	case XML_NAMESPACE_DECL:
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
-			((xmlNsPtr)cur->nodesetval->nodeTab[i])->prefix));
-	    break;
-	default:
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-	}
+    while (cur->next != NULL) {
+	cur = cur->next;
+	if ((cur->type != XML_ENTITY_DECL) &&
+	    (cur->type != XML_DTD_NODE))
+	    return(cur);
     }
-    xmlXPathReleaseObject(ctxt->context, cur);
+
+    do {
+        cur = cur->parent;
+	if (cur == NULL) break;
+	if (cur == ctxt->context->node) return(NULL);
+	if (cur->next != NULL) {
+	    cur = cur->next;
+	    return(cur);
+	}
+    } while (cur != NULL);
+    return(cur);
 }
 
 /**
- * Implement the namespace-uri() XPath function
- *    string namespace-uri(node-set?)
- * The namespace-uri function returns a string containing the
- * namespace URI of the expanded name of the node in the argument
- * node-set that is first in document order. If the node-set is empty,
- * the first node has no name, or the expanded name has no namespace
- * URI, an empty string is returned. If the argument is omitted it
- * defaults to the context node.
+ * Traversal function for the "descendant-or-self" direction
+ * the descendant-or-self axis contains the context node and the descendants
+ * of the context node in document order; thus the context node is the first
+ * node on the axis, and the first child of the context node is the second node
+ * on the axis
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathNamespaceURIFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
+xmlNode *
+xmlXPathNextDescendantOrSelf(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL)
+        return(ctxt->context->node);
 
-    if (ctxt == NULL) return;
+    if (ctxt->context->node == NULL)
+        return(NULL);
+    if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
+        (ctxt->context->node->type == XML_NAMESPACE_DECL))
+        return(NULL);
 
-    if (nargs == 0) {
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt, ctxt->context->node));
-	nargs = 1;
-    }
-    CHECK_ARITY(1);
-    if ((ctxt->value == NULL) ||
-	((ctxt->value->type != XPATH_NODESET) &&
-	 (ctxt->value->type != XPATH_XSLT_TREE)))
-	XP_ERROR(XPATH_INVALID_TYPE);
-    cur = xmlXPathValuePop(ctxt);
-
-    if ((cur->nodesetval == NULL) || (cur->nodesetval->nodeNr == 0)) {
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-    } else {
-	int i = 0; /* Should be first in document order !!!!! */
-	switch (cur->nodesetval->nodeTab[i]->type) {
-	case XML_ELEMENT_NODE:
-	case XML_ATTRIBUTE_NODE:
-	    if (cur->nodesetval->nodeTab[i]->ns == NULL)
-		xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-	    else
-		xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
-			  cur->nodesetval->nodeTab[i]->ns->href));
-	    break;
-	default:
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-	}
-    }
-    xmlXPathReleaseObject(ctxt->context, cur);
-}
+    return(xmlXPathNextDescendant(ctxt, cur));
+}
 
 /**
- * Implement the name() XPath function
- *    string name(node-set?)
- * The name function returns a string containing a QName representing
- * the name of the node in the argument node-set that is first in document
- * order. The QName must represent the name with respect to the namespace
- * declarations in effect on the node whose name is being represented.
- * Typically, this will be the form in which the name occurred in the XML
- * source. This need not be the case if there are namespace declarations
- * in effect on the node that associate multiple prefixes with the same
- * namespace. However, an implementation may include information about
- * the original prefix in its representation of nodes; in this case, an
- * implementation can ensure that the returned string is always the same
- * as the QName used in the XML source. If the argument it omitted it
- * defaults to the context node.
- * Libxml keep the original prefix so the "real qualified name" used is
- * returned.
+ * Traversal function for the "parent" direction
+ * The parent axis contains the parent of the context node, if there is one.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-static void
-xmlXPathNameFunction(xmlXPathParserContextPtr ctxt, int nargs)
-{
-    xmlXPathObjectPtr cur;
-
-    if (nargs == 0) {
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt, ctxt->context->node));
-        nargs = 1;
-    }
-
-    CHECK_ARITY(1);
-    if ((ctxt->value == NULL) ||
-        ((ctxt->value->type != XPATH_NODESET) &&
-         (ctxt->value->type != XPATH_XSLT_TREE)))
-        XP_ERROR(XPATH_INVALID_TYPE);
-    cur = xmlXPathValuePop(ctxt);
-
-    if ((cur->nodesetval == NULL) || (cur->nodesetval->nodeNr == 0)) {
-        xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-    } else {
-        int i = 0;              /* Should be first in document order !!!!! */
-
-        switch (cur->nodesetval->nodeTab[i]->type) {
+xmlNode *
+xmlXPathNextParent(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    /*
+     * the parent of an attribute or namespace node is the element
+     * to which the attribute or namespace node is attached
+     * Namespace handling !!!
+     */
+    if (cur == NULL) {
+	if (ctxt->context->node == NULL) return(NULL);
+	switch (ctxt->context->node->type) {
             case XML_ELEMENT_NODE:
-            case XML_ATTRIBUTE_NODE:
-		if (cur->nodesetval->nodeTab[i]->name[0] == ' ')
-		    xmlXPathValuePush(ctxt,
-			xmlXPathCacheNewCString(ctxt, ""));
-		else if ((cur->nodesetval->nodeTab[i]->ns == NULL) ||
-                         (cur->nodesetval->nodeTab[i]->ns->prefix == NULL)) {
-		    xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
-			    cur->nodesetval->nodeTab[i]->name));
-		} else {
-		    xmlChar *fullname;
-
-		    fullname = xmlBuildQName(cur->nodesetval->nodeTab[i]->name,
-				     cur->nodesetval->nodeTab[i]->ns->prefix,
-				     NULL, 0);
-		    if (fullname == cur->nodesetval->nodeTab[i]->name)
-			fullname = xmlStrdup(cur->nodesetval->nodeTab[i]->name);
-		    if (fullname == NULL)
-                        xmlXPathPErrMemory(ctxt);
-		    xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, fullname));
-                }
-                break;
-            default:
-		xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
-		    cur->nodesetval->nodeTab[i]));
-                xmlXPathLocalNameFunction(ctxt, 1);
-        }
-    }
-    xmlXPathReleaseObject(ctxt->context, cur);
-}
-
-
-/**
- * Implement the string() XPath function
- *    string string(object?)
- * The string function converts an object to a string as follows:
- *    - A node-set is converted to a string by returning the value of
- *      the node in the node-set that is first in document order.
- *      If the node-set is empty, an empty string is returned.
- *    - A number is converted to a string as follows
- *      + NaN is converted to the string NaN
- *      + positive zero is converted to the string 0
- *      + negative zero is converted to the string 0
- *      + positive infinity is converted to the string Infinity
- *      + negative infinity is converted to the string -Infinity
- *      + if the number is an integer, the number is represented in
- *        decimal form as a Number with no decimal point and no leading
- *        zeros, preceded by a minus sign (-) if the number is negative
- *      + otherwise, the number is represented in decimal form as a
- *        Number including a decimal point with at least one digit
- *        before the decimal point and at least one digit after the
- *        decimal point, preceded by a minus sign (-) if the number
- *        is negative; there must be no leading zeros before the decimal
- *        point apart possibly from the one required digit immediately
- *        before the decimal point; beyond the one required digit
- *        after the decimal point there must be as many, but only as
- *        many, more digits as are needed to uniquely distinguish the
- *        number from all other IEEE 754 numeric values.
- *    - The boolean false value is converted to the string false.
- *      The boolean true value is converted to the string true.
- *
- * If the argument is omitted, it defaults to a node-set with the
- * context node as its only member.
- *
- * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
- */
-void
-xmlXPathStringFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
-    xmlChar *stringval;
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+            case XML_ENTITY_REF_NODE:
+            case XML_ENTITY_NODE:
+            case XML_PI_NODE:
+            case XML_COMMENT_NODE:
+            case XML_NOTATION_NODE:
+            case XML_DTD_NODE:
+	    case XML_ELEMENT_DECL:
+	    case XML_ATTRIBUTE_DECL:
+	    case XML_XINCLUDE_START:
+	    case XML_XINCLUDE_END:
+	    case XML_ENTITY_DECL:
+		if (ctxt->context->node->parent == NULL)
+		    return((xmlNodePtr) ctxt->context->doc);
+		if ((ctxt->context->node->parent->type == XML_ELEMENT_NODE) &&
+		    ((ctxt->context->node->parent->name[0] == ' ') ||
+		     (xmlStrEqual(ctxt->context->node->parent->name,
+				 BAD_CAST "fake node libxslt"))))
+		    return(NULL);
+		return(ctxt->context->node->parent);
+            case XML_ATTRIBUTE_NODE: {
+		xmlAttrPtr att = (xmlAttrPtr) ctxt->context->node;
 
-    if (ctxt == NULL) return;
-    if (nargs == 0) {
-        stringval = xmlXPathCastNodeToString(ctxt->context->node);
-        if (stringval == NULL)
-            xmlXPathPErrMemory(ctxt);
-        xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, stringval));
-	return;
-    }
+		return(att->parent);
+	    }
+            case XML_DOCUMENT_NODE:
+            case XML_DOCUMENT_TYPE_NODE:
+            case XML_DOCUMENT_FRAG_NODE:
+            case XML_HTML_DOCUMENT_NODE:
+                return(NULL);
+	    case XML_NAMESPACE_DECL: {
+		xmlNsPtr ns = (xmlNsPtr) ctxt->context->node;
 
-    CHECK_ARITY(1);
-    cur = xmlXPathValuePop(ctxt);
-    if (cur == NULL) XP_ERROR(XPATH_INVALID_OPERAND);
-    if (cur->type != XPATH_STRING) {
-        stringval = xmlXPathCastToString(cur);
-        if (stringval == NULL)
-            xmlXPathPErrMemory(ctxt);
-        xmlXPathReleaseObject(ctxt->context, cur);
-        cur = xmlXPathCacheWrapString(ctxt, stringval);
+		if ((ns->next != NULL) &&
+		    (ns->next->type != XML_NAMESPACE_DECL))
+		    return((xmlNodePtr) ns->next);
+                return(NULL);
+	    }
+	}
     }
-    xmlXPathValuePush(ctxt, cur);
+    return(NULL);
 }
 
 /**
- * Implement the string-length() XPath function
- *    number string-length(string?)
- * The string-length returns the number of characters in the string
- * (see [3.6 Strings]). If the argument is omitted, it defaults to
- * the context node converted to a string, in other words the value
- * of the context node.
+ * Traversal function for the "ancestor" direction
+ * the ancestor axis contains the ancestors of the context node; the ancestors
+ * of the context node consist of the parent of context node and the parent's
+ * parent and so on; the nodes are ordered in reverse document order; thus the
+ * parent is the first node on the axis, and the parent's parent is the second
+ * node on the axis
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathStringLengthFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
+xmlNode *
+xmlXPathNextAncestor(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    /*
+     * the parent of an attribute or namespace node is the element
+     * to which the attribute or namespace node is attached
+     * !!!!!!!!!!!!!
+     */
+    if (cur == NULL) {
+	if (ctxt->context->node == NULL) return(NULL);
+	switch (ctxt->context->node->type) {
+            case XML_ELEMENT_NODE:
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+            case XML_ENTITY_REF_NODE:
+            case XML_ENTITY_NODE:
+            case XML_PI_NODE:
+            case XML_COMMENT_NODE:
+	    case XML_DTD_NODE:
+	    case XML_ELEMENT_DECL:
+	    case XML_ATTRIBUTE_DECL:
+	    case XML_ENTITY_DECL:
+            case XML_NOTATION_NODE:
+	    case XML_XINCLUDE_START:
+	    case XML_XINCLUDE_END:
+		if (ctxt->context->node->parent == NULL)
+		    return((xmlNodePtr) ctxt->context->doc);
+		if ((ctxt->context->node->parent->type == XML_ELEMENT_NODE) &&
+		    ((ctxt->context->node->parent->name[0] == ' ') ||
+		     (xmlStrEqual(ctxt->context->node->parent->name,
+				 BAD_CAST "fake node libxslt"))))
+		    return(NULL);
+		return(ctxt->context->node->parent);
+            case XML_ATTRIBUTE_NODE: {
+		xmlAttrPtr tmp = (xmlAttrPtr) ctxt->context->node;
 
-    if (nargs == 0) {
-        if ((ctxt == NULL) || (ctxt->context == NULL))
-	    return;
-	if (ctxt->context->node == NULL) {
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, 0));
-	} else {
-	    xmlChar *content;
+		return(tmp->parent);
+	    }
+            case XML_DOCUMENT_NODE:
+            case XML_DOCUMENT_TYPE_NODE:
+            case XML_DOCUMENT_FRAG_NODE:
+            case XML_HTML_DOCUMENT_NODE:
+                return(NULL);
+	    case XML_NAMESPACE_DECL: {
+		xmlNsPtr ns = (xmlNsPtr) ctxt->context->node;
 
-	    content = xmlXPathCastNodeToString(ctxt->context->node);
-            if (content == NULL)
-                xmlXPathPErrMemory(ctxt);
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
-		xmlUTF8Strlen(content)));
-	    xmlFree(content);
+		if ((ns->next != NULL) &&
+		    (ns->next->type != XML_NAMESPACE_DECL))
+		    return((xmlNodePtr) ns->next);
+		/* Bad, how did that namespace end up here ? */
+                return(NULL);
+	    }
 	}
-	return;
+	return(NULL);
     }
-    CHECK_ARITY(1);
-    CAST_TO_STRING;
-    CHECK_TYPE(XPATH_STRING);
-    cur = xmlXPathValuePop(ctxt);
-    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
-	xmlUTF8Strlen(cur->stringval)));
-    xmlXPathReleaseObject(ctxt->context, cur);
+    if (cur == ctxt->context->doc->children)
+	return((xmlNodePtr) ctxt->context->doc);
+    if (cur == (xmlNodePtr) ctxt->context->doc)
+	return(NULL);
+    switch (cur->type) {
+	case XML_ELEMENT_NODE:
+	case XML_TEXT_NODE:
+	case XML_CDATA_SECTION_NODE:
+	case XML_ENTITY_REF_NODE:
+	case XML_ENTITY_NODE:
+	case XML_PI_NODE:
+	case XML_COMMENT_NODE:
+	case XML_NOTATION_NODE:
+	case XML_DTD_NODE:
+        case XML_ELEMENT_DECL:
+        case XML_ATTRIBUTE_DECL:
+        case XML_ENTITY_DECL:
+	case XML_XINCLUDE_START:
+	case XML_XINCLUDE_END:
+	    if (cur->parent == NULL)
+		return(NULL);
+	    if ((cur->parent->type == XML_ELEMENT_NODE) &&
+		((cur->parent->name[0] == ' ') ||
+		 (xmlStrEqual(cur->parent->name,
+			      BAD_CAST "fake node libxslt"))))
+		return(NULL);
+	    return(cur->parent);
+	case XML_ATTRIBUTE_NODE: {
+	    xmlAttrPtr att = (xmlAttrPtr) cur;
+
+	    return(att->parent);
+	}
+	case XML_NAMESPACE_DECL: {
+	    xmlNsPtr ns = (xmlNsPtr) cur;
+
+	    if ((ns->next != NULL) &&
+	        (ns->next->type != XML_NAMESPACE_DECL))
+	        return((xmlNodePtr) ns->next);
+	    /* Bad, how did that namespace end up here ? */
+            return(NULL);
+	}
+	case XML_DOCUMENT_NODE:
+	case XML_DOCUMENT_TYPE_NODE:
+	case XML_DOCUMENT_FRAG_NODE:
+	case XML_HTML_DOCUMENT_NODE:
+	    return(NULL);
+    }
+    return(NULL);
 }
 
 /**
- * Implement the concat() XPath function
- *    string concat(string, string, string*)
- * The concat function returns the concatenation of its arguments.
+ * Traversal function for the "ancestor-or-self" direction
+ * he ancestor-or-self axis contains the context node and ancestors of
+ * the context node in reverse document order; thus the context node is
+ * the first node on the axis, and the context node's parent the second;
+ * parent here is defined the same as with the parent axis.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathConcatFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur, newobj;
-    xmlChar *tmp;
-
-    if (ctxt == NULL) return;
-    if (nargs < 2) {
-	CHECK_ARITY(2);
-    }
-
-    CAST_TO_STRING;
-    cur = xmlXPathValuePop(ctxt);
-    if ((cur == NULL) || (cur->type != XPATH_STRING)) {
-	xmlXPathReleaseObject(ctxt->context, cur);
-	return;
-    }
-    nargs--;
-
-    while (nargs > 0) {
-	CAST_TO_STRING;
-	newobj = xmlXPathValuePop(ctxt);
-	if ((newobj == NULL) || (newobj->type != XPATH_STRING)) {
-	    xmlXPathReleaseObject(ctxt->context, newobj);
-	    xmlXPathReleaseObject(ctxt->context, cur);
-	    XP_ERROR(XPATH_INVALID_TYPE);
-	}
-	tmp = xmlStrcat(newobj->stringval, cur->stringval);
-        if (tmp == NULL)
-            xmlXPathPErrMemory(ctxt);
-	newobj->stringval = cur->stringval;
-	cur->stringval = tmp;
-	xmlXPathReleaseObject(ctxt->context, newobj);
-	nargs--;
-    }
-    xmlXPathValuePush(ctxt, cur);
+xmlNode *
+xmlXPathNextAncestorOrSelf(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL)
+        return(ctxt->context->node);
+    return(xmlXPathNextAncestor(ctxt, cur));
 }
 
 /**
- * Implement the contains() XPath function
- *    boolean contains(string, string)
- * The contains function returns true if the first argument string
- * contains the second argument string, and otherwise returns false.
+ * Traversal function for the "following-sibling" direction
+ * The following-sibling axis contains the following siblings of the context
+ * node in document order.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathContainsFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr hay, needle;
-
-    CHECK_ARITY(2);
-    CAST_TO_STRING;
-    CHECK_TYPE(XPATH_STRING);
-    needle = xmlXPathValuePop(ctxt);
-    CAST_TO_STRING;
-    hay = xmlXPathValuePop(ctxt);
-
-    if ((hay == NULL) || (hay->type != XPATH_STRING)) {
-	xmlXPathReleaseObject(ctxt->context, hay);
-	xmlXPathReleaseObject(ctxt->context, needle);
-	XP_ERROR(XPATH_INVALID_TYPE);
-    }
-    if (xmlStrstr(hay->stringval, needle->stringval))
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 1));
-    else
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 0));
-    xmlXPathReleaseObject(ctxt->context, hay);
-    xmlXPathReleaseObject(ctxt->context, needle);
+xmlNode *
+xmlXPathNextFollowingSibling(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
+	(ctxt->context->node->type == XML_NAMESPACE_DECL))
+	return(NULL);
+    if (cur == (xmlNodePtr) ctxt->context->doc)
+        return(NULL);
+    if (cur == NULL)
+        return(ctxt->context->node->next);
+    return(cur->next);
 }
 
 /**
- * Implement the starts-with() XPath function
- *    boolean starts-with(string, string)
- * The starts-with function returns true if the first argument string
- * starts with the second argument string, and otherwise returns false.
+ * Traversal function for the "preceding-sibling" direction
+ * The preceding-sibling axis contains the preceding siblings of the context
+ * node in reverse document order; the first preceding sibling is first on the
+ * axis; the sibling preceding that node is the second on the axis and so on.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathStartsWithFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr hay, needle;
-    int n;
-
-    CHECK_ARITY(2);
-    CAST_TO_STRING;
-    CHECK_TYPE(XPATH_STRING);
-    needle = xmlXPathValuePop(ctxt);
-    CAST_TO_STRING;
-    hay = xmlXPathValuePop(ctxt);
-
-    if ((hay == NULL) || (hay->type != XPATH_STRING)) {
-	xmlXPathReleaseObject(ctxt->context, hay);
-	xmlXPathReleaseObject(ctxt->context, needle);
-	XP_ERROR(XPATH_INVALID_TYPE);
+xmlNode *
+xmlXPathNextPrecedingSibling(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if ((ctxt->context->node->type == XML_ATTRIBUTE_NODE) ||
+	(ctxt->context->node->type == XML_NAMESPACE_DECL))
+	return(NULL);
+    if (cur == (xmlNodePtr) ctxt->context->doc)
+        return(NULL);
+    if (cur == NULL)
+        return(ctxt->context->node->prev);
+    if ((cur->prev != NULL) && (cur->prev->type == XML_DTD_NODE)) {
+	cur = cur->prev;
+	if (cur == NULL)
+	    return(ctxt->context->node->prev);
     }
-    n = xmlStrlen(needle->stringval);
-    if (xmlStrncmp(hay->stringval, needle->stringval, n))
-        xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 0));
-    else
-        xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 1));
-    xmlXPathReleaseObject(ctxt->context, hay);
-    xmlXPathReleaseObject(ctxt->context, needle);
+    return(cur->prev);
 }
 
 /**
- * Implement the substring() XPath function
- *    string substring(string, number, number?)
- * The substring function returns the substring of the first argument
- * starting at the position specified in the second argument with
- * length specified in the third argument. For example,
- * substring("12345",2,3) returns "234". If the third argument is not
- * specified, it returns the substring starting at the position specified
- * in the second argument and continuing to the end of the string. For
- * example, substring("12345",2) returns "2345".  More precisely, each
- * character in the string (see [3.6 Strings]) is considered to have a
- * numeric position: the position of the first character is 1, the position
- * of the second character is 2 and so on. The returned substring contains
- * those characters for which the position of the character is greater than
- * or equal to the second argument and, if the third argument is specified,
- * less than the sum of the second and third arguments; the comparisons
- * and addition used for the above follow the standard IEEE 754 rules. Thus:
- *  - substring("12345", 1.5, 2.6) returns "234"
- *  - substring("12345", 0, 3) returns "12"
- *  - substring("12345", 0 div 0, 3) returns ""
- *  - substring("12345", 1, 0 div 0) returns ""
- *  - substring("12345", -42, 1 div 0) returns "12345"
- *  - substring("12345", -1 div 0, 1 div 0) returns ""
+ * Traversal function for the "following" direction
+ * The following axis contains all nodes in the same document as the context
+ * node that are after the context node in document order, excluding any
+ * descendants and excluding attribute nodes and namespace nodes; the nodes
+ * are ordered in document order
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathSubstringFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr str, start, len;
-    double le=0, in;
-    int i = 1, j = INT_MAX;
+xmlNode *
+xmlXPathNextFollowing(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if ((cur != NULL) && (cur->type  != XML_ATTRIBUTE_NODE) &&
+        (cur->type != XML_NAMESPACE_DECL) && (cur->children != NULL))
+        return(cur->children);
 
-    if (nargs < 2) {
-	CHECK_ARITY(2);
-    }
-    if (nargs > 3) {
-	CHECK_ARITY(3);
-    }
-    /*
-     * take care of possible last (position) argument
-    */
-    if (nargs == 3) {
-	CAST_TO_NUMBER;
-	CHECK_TYPE(XPATH_NUMBER);
-	len = xmlXPathValuePop(ctxt);
-	le = len->floatval;
-	xmlXPathReleaseObject(ctxt->context, len);
-    }
-
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
-    start = xmlXPathValuePop(ctxt);
-    in = start->floatval;
-    xmlXPathReleaseObject(ctxt->context, start);
-    CAST_TO_STRING;
-    CHECK_TYPE(XPATH_STRING);
-    str = xmlXPathValuePop(ctxt);
-
-    if (!(in < INT_MAX)) { /* Logical NOT to handle NaNs */
-        i = INT_MAX;
-    } else if (in >= 1.0) {
-        i = (int)in;
-        if (in - floor(in) >= 0.5)
-            i += 1;
-    }
-
-    if (nargs == 3) {
-        double rin, rle, end;
-
-        rin = floor(in);
-        if (in - rin >= 0.5)
-            rin += 1.0;
-
-        rle = floor(le);
-        if (le - rle >= 0.5)
-            rle += 1.0;
+    if (cur == NULL) {
+        cur = ctxt->context->node;
+        if (cur->type == XML_ATTRIBUTE_NODE) {
+            cur = cur->parent;
+        } else if (cur->type == XML_NAMESPACE_DECL) {
+            xmlNsPtr ns = (xmlNsPtr) cur;
 
-        end = rin + rle;
-        if (!(end >= 1.0)) { /* Logical NOT to handle NaNs */
-            j = 1;
-        } else if (end < INT_MAX) {
-            j = (int)end;
+            if ((ns->next == NULL) ||
+                (ns->next->type == XML_NAMESPACE_DECL))
+                return (NULL);
+            cur = (xmlNodePtr) ns->next;
         }
     }
-
-    i -= 1;
-    j -= 1;
-
-    if ((i < j) && (i < xmlUTF8Strlen(str->stringval))) {
-        xmlChar *ret = xmlUTF8Strsub(str->stringval, i, j - i);
-        if (ret == NULL)
-            xmlXPathPErrMemory(ctxt);
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt, ret));
-	xmlFree(ret);
-    } else {
-	xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
-    }
-
-    xmlXPathReleaseObject(ctxt->context, str);
+    if (cur == NULL) return(NULL) ; /* ERROR */
+    if (cur->next != NULL) return(cur->next) ;
+    do {
+        cur = cur->parent;
+        if (cur == NULL) break;
+        if (cur == (xmlNodePtr) ctxt->context->doc) return(NULL);
+        if (cur->next != NULL) return(cur->next);
+    } while (cur != NULL);
+    return(cur);
 }
 
-/**
- * Implement the substring-before() XPath function
- *    string substring-before(string, string)
- * The substring-before function returns the substring of the first
- * argument string that precedes the first occurrence of the second
- * argument string in the first argument string, or the empty string
- * if the first argument string does not contain the second argument
- * string. For example, substring-before("1999/04/01","/") returns 1999.
+/*
+ * @param ancestor  the ancestor node
+ * @param node  the current node
  *
- * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * Check that `ancestor` is a `node`'s ancestor
+ *
+ * @returns 1 if `ancestor` is a `node`'s ancestor, 0 otherwise.
  */
-void
-xmlXPathSubstringBeforeFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr str = NULL;
-    xmlXPathObjectPtr find = NULL;
-    const xmlChar *point;
-    xmlChar *result;
-
-    CHECK_ARITY(2);
-    CAST_TO_STRING;
-    find = xmlXPathValuePop(ctxt);
-    CAST_TO_STRING;
-    str = xmlXPathValuePop(ctxt);
-    if (ctxt->error != 0)
-        goto error;
-
-    point = xmlStrstr(str->stringval, find->stringval);
-    if (point == NULL) {
-        result = xmlStrdup(BAD_CAST "");
-    } else {
-        result = xmlStrndup(str->stringval, point - str->stringval);
-    }
-    if (result == NULL) {
-        xmlXPathPErrMemory(ctxt);
-        goto error;
+static int
+xmlXPathIsAncestor(xmlNodePtr ancestor, xmlNodePtr node) {
+    if ((ancestor == NULL) || (node == NULL)) return(0);
+    if (node->type == XML_NAMESPACE_DECL)
+        return(0);
+    if (ancestor->type == XML_NAMESPACE_DECL)
+        return(0);
+    /* nodes need to be in the same document */
+    if (ancestor->doc != node->doc) return(0);
+    /* avoid searching if ancestor or node is the root node */
+    if (ancestor == (xmlNodePtr) node->doc) return(1);
+    if (node == (xmlNodePtr) ancestor->doc) return(0);
+    while (node->parent != NULL) {
+        if (node->parent == ancestor)
+            return(1);
+	node = node->parent;
     }
-    xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, result));
-
-error:
-    xmlXPathReleaseObject(ctxt->context, str);
-    xmlXPathReleaseObject(ctxt->context, find);
+    return(0);
 }
 
 /**
- * Implement the substring-after() XPath function
- *    string substring-after(string, string)
- * The substring-after function returns the substring of the first
- * argument string that follows the first occurrence of the second
- * argument string in the first argument string, or the empty string
- * if the first argument string does not contain the second argument
- * string. For example, substring-after("1999/04/01","/") returns 04/01,
- * and substring-after("1999/04/01","19") returns 99/04/01.
+ * Traversal function for the "preceding" direction
+ * the preceding axis contains all nodes in the same document as the context
+ * node that are before the context node in document order, excluding any
+ * ancestors and excluding attribute nodes and namespace nodes; the nodes are
+ * ordered in reverse document order
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathSubstringAfterFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr str = NULL;
-    xmlXPathObjectPtr find = NULL;
-    const xmlChar *point;
-    xmlChar *result;
-
-    CHECK_ARITY(2);
-    CAST_TO_STRING;
-    find = xmlXPathValuePop(ctxt);
-    CAST_TO_STRING;
-    str = xmlXPathValuePop(ctxt);
-    if (ctxt->error != 0)
-        goto error;
+xmlNode *
+xmlXPathNextPreceding(xmlXPathParserContext *ctxt, xmlNode *cur)
+{
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL) {
+        cur = ctxt->context->node;
+        if (cur->type == XML_ATTRIBUTE_NODE) {
+            cur = cur->parent;
+        } else if (cur->type == XML_NAMESPACE_DECL) {
+            xmlNsPtr ns = (xmlNsPtr) cur;
 
-    point = xmlStrstr(str->stringval, find->stringval);
-    if (point == NULL) {
-        result = xmlStrdup(BAD_CAST "");
-    } else {
-        result = xmlStrdup(point + xmlStrlen(find->stringval));
-    }
-    if (result == NULL) {
-        xmlXPathPErrMemory(ctxt);
-        goto error;
+            if ((ns->next == NULL) ||
+                (ns->next->type == XML_NAMESPACE_DECL))
+                return (NULL);
+            cur = (xmlNodePtr) ns->next;
+        }
     }
-    xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, result));
+    if ((cur == NULL) || (cur->type == XML_NAMESPACE_DECL))
+	return (NULL);
+    if ((cur->prev != NULL) && (cur->prev->type == XML_DTD_NODE))
+	cur = cur->prev;
+    do {
+        if (cur->prev != NULL) {
+            for (cur = cur->prev; cur->last != NULL; cur = cur->last) ;
+            return (cur);
+        }
 
-error:
-    xmlXPathReleaseObject(ctxt->context, str);
-    xmlXPathReleaseObject(ctxt->context, find);
+        cur = cur->parent;
+        if (cur == NULL)
+            return (NULL);
+        if (cur == ctxt->context->doc->children)
+            return (NULL);
+    } while (xmlXPathIsAncestor(cur, ctxt->context->node));
+    return (cur);
 }
 
 /**
- * Implement the normalize-space() XPath function
- *    string normalize-space(string?)
- * The normalize-space function returns the argument string with white
- * space normalized by stripping leading and trailing whitespace
- * and replacing sequences of whitespace characters by a single
- * space. Whitespace characters are the same allowed by the S production
- * in XML. If the argument is omitted, it defaults to the context
- * node converted to a string, in other words the value of the context node.
+ * Traversal function for the "preceding" direction
+ * the preceding axis contains all nodes in the same document as the context
+ * node that are before the context node in document order, excluding any
+ * ancestors and excluding attribute nodes and namespace nodes; the nodes are
+ * ordered in reverse document order
+ * This is a faster implementation but internal only since it requires a
+ * state kept in the parser context: ctxt->ancestor.
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current node in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathNormalizeFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlChar *source, *target;
-    int blank;
+static xmlNodePtr
+xmlXPathNextPrecedingInternal(xmlXPathParserContextPtr ctxt,
+                              xmlNodePtr cur)
+{
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (cur == NULL) {
+        cur = ctxt->context->node;
+        if (cur == NULL)
+            return (NULL);
+        if (cur->type == XML_ATTRIBUTE_NODE) {
+            cur = cur->parent;
+        } else if (cur->type == XML_NAMESPACE_DECL) {
+            xmlNsPtr ns = (xmlNsPtr) cur;
 
-    if (ctxt == NULL) return;
-    if (nargs == 0) {
-        /* Use current context node */
-        source = xmlXPathCastNodeToString(ctxt->context->node);
-        if (source == NULL)
-            xmlXPathPErrMemory(ctxt);
-        xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, source));
-        nargs = 1;
+            if ((ns->next == NULL) ||
+                (ns->next->type == XML_NAMESPACE_DECL))
+                return (NULL);
+            cur = (xmlNodePtr) ns->next;
+        }
+        ctxt->ancestor = cur->parent;
     }
+    if (cur->type == XML_NAMESPACE_DECL)
+        return(NULL);
+    if ((cur->prev != NULL) && (cur->prev->type == XML_DTD_NODE))
+	cur = cur->prev;
+    while (cur->prev == NULL) {
+        cur = cur->parent;
+        if (cur == NULL)
+            return (NULL);
+        if (cur == ctxt->context->doc->children)
+            return (NULL);
+        if (cur != ctxt->ancestor)
+            return (cur);
+        ctxt->ancestor = cur->parent;
+    }
+    cur = cur->prev;
+    while (cur->last != NULL)
+        cur = cur->last;
+    return (cur);
+}
 
-    CHECK_ARITY(1);
-    CAST_TO_STRING;
-    CHECK_TYPE(XPATH_STRING);
-    source = ctxt->value->stringval;
-    if (source == NULL)
-        return;
-    target = source;
-
-    /* Skip leading whitespaces */
-    while (IS_BLANK_CH(*source))
-        source++;
-
-    /* Collapse intermediate whitespaces, and skip trailing whitespaces */
-    blank = 0;
-    while (*source) {
-        if (IS_BLANK_CH(*source)) {
-	    blank = 1;
-        } else {
-            if (blank) {
-                *target++ = 0x20;
-                blank = 0;
+/**
+ * Traversal function for the "namespace" direction
+ * the namespace axis contains the namespace nodes of the context node;
+ * the order of nodes on this axis is implementation-defined; the axis will
+ * be empty unless the context node is an element
+ *
+ * We keep the XML namespace node at the end of the list.
+ *
+ * @param ctxt  the XPath Parser context
+ * @param cur  the current attribute in the traversal
+ * @returns the next element following that axis
+ */
+xmlNode *
+xmlXPathNextNamespace(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (ctxt->context->node->type != XML_ELEMENT_NODE) return(NULL);
+    if (cur == NULL) {
+        if (ctxt->context->tmpNsList != NULL)
+	    xmlFree(ctxt->context->tmpNsList);
+	ctxt->context->tmpNsNr = 0;
+        if (xmlGetNsListSafe(ctxt->context->doc, ctxt->context->node,
+                             &ctxt->context->tmpNsList) < 0) {
+            xmlXPathPErrMemory(ctxt);
+            return(NULL);
+        }
+        if (ctxt->context->tmpNsList != NULL) {
+            while (ctxt->context->tmpNsList[ctxt->context->tmpNsNr] != NULL) {
+                ctxt->context->tmpNsNr++;
             }
-            *target++ = *source;
         }
-        source++;
+	return((xmlNodePtr) xmlXPathXMLNamespace);
+    }
+    if (ctxt->context->tmpNsNr > 0) {
+	return (xmlNodePtr)ctxt->context->tmpNsList[--ctxt->context->tmpNsNr];
+    } else {
+	if (ctxt->context->tmpNsList != NULL)
+	    xmlFree(ctxt->context->tmpNsList);
+	ctxt->context->tmpNsList = NULL;
+	return(NULL);
     }
-    *target = 0;
 }
 
 /**
- * Implement the translate() XPath function
- *    string translate(string, string, string)
- * The translate function returns the first argument string with
- * occurrences of characters in the second argument string replaced
- * by the character at the corresponding position in the third argument
- * string. For example, translate("bar","abc","ABC") returns the string
- * BAr. If there is a character in the second argument string with no
- * character at a corresponding position in the third argument string
- * (because the second argument string is longer than the third argument
- * string), then occurrences of that character in the first argument
- * string are removed. For example,
- * translate("--aaa--","abc-","ABC") returns "AAA".
- * If a character occurs more than once in second
- * argument string, then the first occurrence determines the replacement
- * character. If the third argument string is longer than the second
- * argument string, then excess characters are ignored.
+ * Traversal function for the "attribute" direction
+ * TODO: support DTD inherited default attributes
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param cur  the current attribute in the traversal
+ * @returns the next element following that axis
  */
-void
-xmlXPathTranslateFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr str = NULL;
-    xmlXPathObjectPtr from = NULL;
-    xmlXPathObjectPtr to = NULL;
-    xmlBufPtr target;
-    int offset, max;
-    int ch;
-    const xmlChar *point;
-    xmlChar *cptr, *content;
-
-    CHECK_ARITY(3);
-
-    CAST_TO_STRING;
-    to = xmlXPathValuePop(ctxt);
-    CAST_TO_STRING;
-    from = xmlXPathValuePop(ctxt);
-    CAST_TO_STRING;
-    str = xmlXPathValuePop(ctxt);
-    if (ctxt->error != 0)
-        goto error;
-
-    /*
-     * Account for quadratic runtime
-     */
-    if (ctxt->context->opLimit != 0) {
-        unsigned long f1 = xmlStrlen(from->stringval);
-        unsigned long f2 = xmlStrlen(str->stringval);
-
-        if ((f1 > 0) && (f2 > 0)) {
-            unsigned long p;
-
-            f1 = f1 / 10 + 1;
-            f2 = f2 / 10 + 1;
-            p = f1 > ULONG_MAX / f2 ? ULONG_MAX : f1 * f2;
-            if (xmlXPathCheckOpLimit(ctxt, p) < 0)
-                goto error;
-        }
+xmlNode *
+xmlXPathNextAttribute(xmlXPathParserContext *ctxt, xmlNode *cur) {
+    if ((ctxt == NULL) || (ctxt->context == NULL)) return(NULL);
+    if (ctxt->context->node == NULL)
+	return(NULL);
+    if (ctxt->context->node->type != XML_ELEMENT_NODE)
+	return(NULL);
+    if (cur == NULL) {
+        if (ctxt->context->node == (xmlNodePtr) ctxt->context->doc)
+	    return(NULL);
+        return((xmlNodePtr)ctxt->context->node->properties);
     }
+    return((xmlNodePtr)cur->next);
+}
 
-    target = xmlBufCreate(50);
-    if (target == NULL) {
-        xmlXPathPErrMemory(ctxt);
-        goto error;
-    }
+/************************************************************************
+ *									*
+ *		NodeTest Functions					*
+ *									*
+ ************************************************************************/
 
-    max = xmlUTF8Strlen(to->stringval);
-    for (cptr = str->stringval; (ch=*cptr); ) {
-        offset = xmlUTF8Strloc(from->stringval, cptr);
-        if (offset >= 0) {
-            if (offset < max) {
-                point = xmlUTF8Strpos(to->stringval, offset);
-                if (point)
-                    xmlBufAdd(target, point, xmlUTF8Strsize(point, 1));
-            }
-        } else
-            xmlBufAdd(target, cptr, xmlUTF8Strsize(cptr, 1));
+#define IS_FUNCTION			200
 
-        /* Step to next character in input */
-        cptr++;
-        if ( ch & 0x80 ) {
-            /* if not simple ascii, verify proper format */
-            if ( (ch & 0xc0) != 0xc0 ) {
-                xmlXPathErr(ctxt, XPATH_INVALID_CHAR_ERROR);
-                break;
-            }
-            /* then skip over remaining bytes for this char */
-            while ( (ch <<= 1) & 0x80 )
-                if ( (*cptr++ & 0xc0) != 0x80 ) {
-                    xmlXPathErr(ctxt, XPATH_INVALID_CHAR_ERROR);
-                    break;
-                }
-            if (ch & 0x80) /* must have had error encountered */
-                break;
-        }
-    }
 
-    content = xmlBufDetach(target);
-    if (content == NULL)
-        xmlXPathPErrMemory(ctxt);
-    else
-        xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, content));
-    xmlBufFree(target);
-error:
-    xmlXPathReleaseObject(ctxt->context, str);
-    xmlXPathReleaseObject(ctxt->context, from);
-    xmlXPathReleaseObject(ctxt->context, to);
-}
+/************************************************************************
+ *									*
+ *		Implicit tree core function library			*
+ *									*
+ ************************************************************************/
 
 /**
- * Implement the boolean() XPath function
- *    boolean boolean(object)
- * The boolean function converts its argument to a boolean as follows:
- *    - a number is true if and only if it is neither positive or
- *      negative zero nor NaN
- *    - a node-set is true if and only if it is non-empty
- *    - a string is true if and only if its length is non-zero
+ * Initialize the context to the root of the document
  *
  * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
  */
 void
-xmlXPathBooleanFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
+xmlXPathRoot(xmlXPathParserContext *ctxt) {
+    if ((ctxt == NULL) || (ctxt->context == NULL))
+	return;
+    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
+                                            (xmlNodePtr) ctxt->context->doc));
+}
 
-    CHECK_ARITY(1);
-    cur = xmlXPathValuePop(ctxt);
-    if (cur == NULL) XP_ERROR(XPATH_INVALID_OPERAND);
-    if (cur->type != XPATH_BOOLEAN) {
-        int boolval = xmlXPathCastToBoolean(cur);
+/************************************************************************
+ *									*
+ *		The explicit core function library			*
+ *http://www.w3.org/Style/XSL/Group/1999/07/xpath-19990705.html#corelib	*
+ *									*
+ ************************************************************************/
 
-        xmlXPathReleaseObject(ctxt->context, cur);
-        cur = xmlXPathCacheNewBoolean(ctxt, boolval);
-    }
-    xmlXPathValuePush(ctxt, cur);
-}
 
 /**
- * Implement the not() XPath function
- *    boolean not(boolean)
- * The not function returns true if its argument is false,
- * and false otherwise.
+ * Implement the last() XPath function
+ *    number last()
+ * The last function returns the number of nodes in the context node list.
  *
  * @param ctxt  the XPath Parser context
  * @param nargs  the number of arguments
  */
 void
-xmlXPathNotFunction(xmlXPathParserContext *ctxt, int nargs) {
-    CHECK_ARITY(1);
-    CAST_TO_BOOLEAN;
-    CHECK_TYPE(XPATH_BOOLEAN);
-    ctxt->value->boolval = ! ctxt->value->boolval;
-}
-
-/**
- * Implement the true() XPath function
- *    boolean true()
- *
- * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
- */
-void
-xmlXPathTrueFunction(xmlXPathParserContext *ctxt, int nargs) {
+xmlXPathLastFunction(xmlXPathParserContext *ctxt, int nargs) {
     CHECK_ARITY(0);
-    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 1));
+    if (ctxt->context->contextSize >= 0) {
+	xmlXPathValuePush(ctxt,
+	    xmlXPathCacheNewFloat(ctxt, (double) ctxt->context->contextSize));
+    } else {
+	XP_ERROR(XPATH_INVALID_CTXT_SIZE);
+    }
 }
 
 /**
- * Implement the false() XPath function
- *    boolean false()
+ * Implement the position() XPath function
+ *    number position()
+ * The position function returns the position of the context node in the
+ * context node list. The first position is 1, and so the last position
+ * will be equal to last().
  *
  * @param ctxt  the XPath Parser context
  * @param nargs  the number of arguments
  */
 void
-xmlXPathFalseFunction(xmlXPathParserContext *ctxt, int nargs) {
+xmlXPathPositionFunction(xmlXPathParserContext *ctxt, int nargs) {
     CHECK_ARITY(0);
-    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 0));
+    if (ctxt->context->proximityPosition >= 0) {
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
+            (double) ctxt->context->proximityPosition));
+    } else {
+	XP_ERROR(XPATH_INVALID_CTXT_POSITION);
+    }
 }
 
 /**
- * Implement the lang() XPath function
- *    boolean lang(string)
- * The lang function returns true or false depending on whether the
- * language of the context node as specified by xml:lang attributes
- * is the same as or is a sublanguage of the language specified by
- * the argument string. The language of the context node is determined
- * by the value of the xml:lang attribute on the context node, or, if
- * the context node has no xml:lang attribute, by the value of the
- * xml:lang attribute on the nearest ancestor of the context node that
- * has an xml:lang attribute. If there is no such attribute, then
- * lang returns false. If there is such an attribute, then lang returns
- * true if the attribute value is equal to the argument ignoring case,
- * or if there is some suffix starting with - such that the attribute
- * value is equal to the argument ignoring that suffix of the attribute
- * value and ignoring case.
+ * Implement the count() XPath function
+ *    number count(node-set)
  *
  * @param ctxt  the XPath Parser context
  * @param nargs  the number of arguments
  */
 void
-xmlXPathLangFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr val;
-    xmlNodePtr cur;
-    xmlChar *theLang;
-    const xmlChar *lang;
-    int ret = 0;
-    int i;
+xmlXPathCountFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
 
     CHECK_ARITY(1);
-    CAST_TO_STRING;
-    CHECK_TYPE(XPATH_STRING);
-    val = xmlXPathValuePop(ctxt);
-    lang = val->stringval;
-    cur = ctxt->context->node;
-    while (cur != NULL) {
-        if (xmlNodeGetAttrValue(cur, BAD_CAST "lang", XML_XML_NAMESPACE,
-                                &theLang) < 0)
-            xmlXPathPErrMemory(ctxt);
-        if (theLang != NULL)
-            break;
-        cur = cur->parent;
-    }
-    if ((theLang != NULL) && (lang != NULL)) {
-        for (i = 0;lang[i] != 0;i++)
-            if (toupper(lang[i]) != toupper(theLang[i]))
-                goto not_equal;
-        if ((theLang[i] == 0) || (theLang[i] == '-'))
-            ret = 1;
-    }
-not_equal:
-    if (theLang != NULL)
-	xmlFree((void *)theLang);
+    if ((ctxt->value == NULL) ||
+	((ctxt->value->type != XPATH_NODESET) &&
+	 (ctxt->value->type != XPATH_XSLT_TREE)))
+	XP_ERROR(XPATH_INVALID_TYPE);
+    cur = xmlXPathValuePop(ctxt);
 
-    xmlXPathReleaseObject(ctxt->context, val);
-    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, ret));
+    if ((cur == NULL) || (cur->nodesetval == NULL))
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, 0.0));
+    else
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
+	    (double) cur->nodesetval->nodeNr));
+    xmlXPathReleaseObject(ctxt->context, cur);
 }
 
 /**
- * Implement the number() XPath function
- *    number number(object?)
+ * Selects elements by their unique ID.
  *
- * @param ctxt  the XPath Parser context
- * @param nargs  the number of arguments
+ * @param doc  the document
+ * @param ids  a whitespace separated list of IDs
+ * @returns a node-set of selected elements.
  */
-void
-xmlXPathNumberFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
-    double res;
+static xmlNodeSetPtr
+xmlXPathGetElementsByIds (xmlDocPtr doc, const xmlChar *ids) {
+    xmlNodeSetPtr ret;
+    const xmlChar *cur = ids;
+    xmlChar *ID;
+    xmlAttrPtr attr;
+    xmlNodePtr elem = NULL;
 
-    if (ctxt == NULL) return;
-    if (nargs == 0) {
-	if (ctxt->context->node == NULL) {
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, 0.0));
-	} else {
-	    xmlChar* content = xmlNodeGetContent(ctxt->context->node);
-            if (content == NULL)
-                xmlXPathPErrMemory(ctxt);
+    if (ids == NULL) return(NULL);
 
-	    res = xmlXPathStringEvalNumber(content);
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, res));
-	    xmlFree(content);
-	}
-	return;
-    }
+    ret = xmlXPathNodeSetCreate(NULL);
+    if (ret == NULL)
+        return(ret);
 
-    CHECK_ARITY(1);
-    cur = xmlXPathValuePop(ctxt);
-    if (cur->type != XPATH_NUMBER) {
-        double floatval;
+    while (IS_BLANK_CH(*cur)) cur++;
+    while (*cur != 0) {
+	while ((!IS_BLANK_CH(*cur)) && (*cur != 0))
+	    cur++;
 
-        floatval = xmlXPathCastToNumberInternal(ctxt, cur);
-        xmlXPathReleaseObject(ctxt->context, cur);
-        cur = xmlXPathCacheNewFloat(ctxt, floatval);
+        ID = xmlStrndup(ids, cur - ids);
+	if (ID == NULL) {
+            xmlXPathFreeNodeSet(ret);
+            return(NULL);
+        }
+        /*
+         * We used to check the fact that the value passed
+         * was an NCName, but this generated much troubles for
+         * me and Aleksey Sanin, people blatantly violated that
+         * constraint, like Visa3D spec.
+         * if (xmlValidateNCName(ID, 1) == 0)
+         */
+        attr = xmlGetID(doc, ID);
+        xmlFree(ID);
+        if (attr != NULL) {
+            if (attr->type == XML_ATTRIBUTE_NODE)
+                elem = attr->parent;
+            else if (attr->type == XML_ELEMENT_NODE)
+                elem = (xmlNodePtr) attr;
+            else
+                elem = NULL;
+            if (elem != NULL) {
+                if (xmlXPathNodeSetAdd(ret, elem) < 0) {
+                    xmlXPathFreeNodeSet(ret);
+                    return(NULL);
+                }
+            }
+        }
+
+	while (IS_BLANK_CH(*cur)) cur++;
+	ids = cur;
     }
-    xmlXPathValuePush(ctxt, cur);
+    return(ret);
 }
 
 /**
- * Implement the sum() XPath function
- *    number sum(node-set)
- * The sum function returns the sum of the values of the nodes in
- * the argument node-set.
+ * Implement the id() XPath function
+ *    node-set id(object)
+ * The id function selects elements by their unique ID
+ * (see [5.2.1 Unique IDs]). When the argument to id is of type node-set,
+ * then the result is the union of the result of applying id to the
+ * string value of each of the nodes in the argument node-set. When the
+ * argument to id is of any other type, the argument is converted to a
+ * string as if by a call to the string function; the string is split
+ * into a whitespace-separated list of tokens (whitespace is any sequence
+ * of characters matching the production S); the result is a node-set
+ * containing the elements in the same document as the context node that
+ * have a unique ID equal to any of the tokens in the list.
  *
  * @param ctxt  the XPath Parser context
  * @param nargs  the number of arguments
  */
 void
-xmlXPathSumFunction(xmlXPathParserContext *ctxt, int nargs) {
-    xmlXPathObjectPtr cur;
-    int i;
-    double res = 0.0;
+xmlXPathIdFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlChar *tokens;
+    xmlNodeSetPtr ret;
+    xmlXPathObjectPtr obj;
 
     CHECK_ARITY(1);
-    if ((ctxt->value == NULL) ||
-	((ctxt->value->type != XPATH_NODESET) &&
-	 (ctxt->value->type != XPATH_XSLT_TREE)))
-	XP_ERROR(XPATH_INVALID_TYPE);
-    cur = xmlXPathValuePop(ctxt);
+    obj = xmlXPathValuePop(ctxt);
+    if (obj == NULL) XP_ERROR(XPATH_INVALID_OPERAND);
+    if ((obj->type == XPATH_NODESET) || (obj->type == XPATH_XSLT_TREE)) {
+	xmlNodeSetPtr ns;
+	int i;
 
-    if ((cur->nodesetval != NULL) && (cur->nodesetval->nodeNr != 0)) {
-	for (i = 0; i < cur->nodesetval->nodeNr; i++) {
-	    res += xmlXPathNodeToNumberInternal(ctxt,
-                                                cur->nodesetval->nodeTab[i]);
+	ret = xmlXPathNodeSetCreate(NULL);
+        if (ret == NULL)
+            xmlXPathPErrMemory(ctxt);
+
+	if (obj->nodesetval != NULL) {
+	    for (i = 0; i < obj->nodesetval->nodeNr; i++) {
+		tokens =
+		    xmlXPathCastNodeToString(obj->nodesetval->nodeTab[i]);
+                if (tokens == NULL)
+                    xmlXPathPErrMemory(ctxt);
+		ns = xmlXPathGetElementsByIds(ctxt->context->doc, tokens);
+                if (ns == NULL)
+                    xmlXPathPErrMemory(ctxt);
+		ret = xmlXPathNodeSetMerge(ret, ns);
+                if (ret == NULL)
+                    xmlXPathPErrMemory(ctxt);
+		xmlXPathFreeNodeSet(ns);
+		if (tokens != NULL)
+		    xmlFree(tokens);
+	    }
 	}
+	xmlXPathReleaseObject(ctxt->context, obj);
+	xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, ret));
+	return;
     }
-    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, res));
-    xmlXPathReleaseObject(ctxt->context, cur);
+    tokens = xmlXPathCastToString(obj);
+    if (tokens == NULL)
+        xmlXPathPErrMemory(ctxt);
+    xmlXPathReleaseObject(ctxt->context, obj);
+    ret = xmlXPathGetElementsByIds(ctxt->context->doc, tokens);
+    if (ret == NULL)
+        xmlXPathPErrMemory(ctxt);
+    xmlFree(tokens);
+    xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, ret));
 }
 
 /**
- * Implement the floor() XPath function
- *    number floor(number)
- * The floor function returns the largest (closest to positive infinity)
- * number that is not greater than the argument and that is an integer.
+ * Implement the local-name() XPath function
+ *    string local-name(node-set?)
+ * The local-name function returns a string containing the local part
+ * of the name of the node in the argument node-set that is first in
+ * document order. If the node-set is empty or the first node has no
+ * name, an empty string is returned. If the argument is omitted it
+ * defaults to the context node.
  *
  * @param ctxt  the XPath Parser context
  * @param nargs  the number of arguments
  */
 void
-xmlXPathFloorFunction(xmlXPathParserContext *ctxt, int nargs) {
+xmlXPathLocalNameFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
+
+    if (ctxt == NULL) return;
+
+    if (nargs == 0) {
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt, ctxt->context->node));
+	nargs = 1;
+    }
+
     CHECK_ARITY(1);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
+    if ((ctxt->value == NULL) ||
+	((ctxt->value->type != XPATH_NODESET) &&
+	 (ctxt->value->type != XPATH_XSLT_TREE)))
+	XP_ERROR(XPATH_INVALID_TYPE);
+    cur = xmlXPathValuePop(ctxt);
 
-    ctxt->value->floatval = floor(ctxt->value->floatval);
+    if ((cur->nodesetval == NULL) || (cur->nodesetval->nodeNr == 0)) {
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
+    } else {
+	int i = 0; /* Should be first in document order !!!!! */
+	switch (cur->nodesetval->nodeTab[i]->type) {
+	case XML_ELEMENT_NODE:
+	case XML_ATTRIBUTE_NODE:
+	case XML_PI_NODE:
+	    if (cur->nodesetval->nodeTab[i]->name[0] == ' ')
+		xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
+	    else
+		xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
+			cur->nodesetval->nodeTab[i]->name));
+	    break;
+	case XML_NAMESPACE_DECL:
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
+			((xmlNsPtr)cur->nodesetval->nodeTab[i])->prefix));
+	    break;
+	default:
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
+	}
+    }
+    xmlXPathReleaseObject(ctxt->context, cur);
 }
 
 /**
- * Implement the ceiling() XPath function
- *    number ceiling(number)
- * The ceiling function returns the smallest (closest to negative infinity)
- * number that is not less than the argument and that is an integer.
+ * Implement the namespace-uri() XPath function
+ *    string namespace-uri(node-set?)
+ * The namespace-uri function returns a string containing the
+ * namespace URI of the expanded name of the node in the argument
+ * node-set that is first in document order. If the node-set is empty,
+ * the first node has no name, or the expanded name has no namespace
+ * URI, an empty string is returned. If the argument is omitted it
+ * defaults to the context node.
  *
  * @param ctxt  the XPath Parser context
  * @param nargs  the number of arguments
  */
 void
-xmlXPathCeilingFunction(xmlXPathParserContext *ctxt, int nargs) {
+xmlXPathNamespaceURIFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
+
+    if (ctxt == NULL) return;
+
+    if (nargs == 0) {
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt, ctxt->context->node));
+	nargs = 1;
+    }
     CHECK_ARITY(1);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
+    if ((ctxt->value == NULL) ||
+	((ctxt->value->type != XPATH_NODESET) &&
+	 (ctxt->value->type != XPATH_XSLT_TREE)))
+	XP_ERROR(XPATH_INVALID_TYPE);
+    cur = xmlXPathValuePop(ctxt);
 
-#ifdef _AIX
-    /* Work around buggy ceil() function on AIX */
-    ctxt->value->floatval = copysign(ceil(ctxt->value->floatval), ctxt->value->floatval);
-#else
-    ctxt->value->floatval = ceil(ctxt->value->floatval);
-#endif
+    if ((cur->nodesetval == NULL) || (cur->nodesetval->nodeNr == 0)) {
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
+    } else {
+	int i = 0; /* Should be first in document order !!!!! */
+	switch (cur->nodesetval->nodeTab[i]->type) {
+	case XML_ELEMENT_NODE:
+	case XML_ATTRIBUTE_NODE:
+	    if (cur->nodesetval->nodeTab[i]->ns == NULL)
+		xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
+	    else
+		xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
+			  cur->nodesetval->nodeTab[i]->ns->href));
+	    break;
+	default:
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
+	}
+    }
+    xmlXPathReleaseObject(ctxt->context, cur);
 }
 
 /**
- * Implement the round() XPath function
- *    number round(number)
- * The round function returns the number that is closest to the
- * argument and that is an integer. If there are two such numbers,
- * then the one that is closest to positive infinity is returned.
+ * Implement the name() XPath function
+ *    string name(node-set?)
+ * The name function returns a string containing a QName representing
+ * the name of the node in the argument node-set that is first in document
+ * order. The QName must represent the name with respect to the namespace
+ * declarations in effect on the node whose name is being represented.
+ * Typically, this will be the form in which the name occurred in the XML
+ * source. This need not be the case if there are namespace declarations
+ * in effect on the node that associate multiple prefixes with the same
+ * namespace. However, an implementation may include information about
+ * the original prefix in its representation of nodes; in this case, an
+ * implementation can ensure that the returned string is always the same
+ * as the QName used in the XML source. If the argument it omitted it
+ * defaults to the context node.
+ * Libxml keep the original prefix so the "real qualified name" used is
+ * returned.
  *
  * @param ctxt  the XPath Parser context
  * @param nargs  the number of arguments
  */
-void
-xmlXPathRoundFunction(xmlXPathParserContext *ctxt, int nargs) {
-    double f;
+static void
+xmlXPathNameFunction(xmlXPathParserContextPtr ctxt, int nargs)
+{
+    xmlXPathObjectPtr cur;
+
+    if (nargs == 0) {
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt, ctxt->context->node));
+        nargs = 1;
+    }
 
     CHECK_ARITY(1);
-    CAST_TO_NUMBER;
-    CHECK_TYPE(XPATH_NUMBER);
+    if ((ctxt->value == NULL) ||
+        ((ctxt->value->type != XPATH_NODESET) &&
+         (ctxt->value->type != XPATH_XSLT_TREE)))
+        XP_ERROR(XPATH_INVALID_TYPE);
+    cur = xmlXPathValuePop(ctxt);
 
-    f = ctxt->value->floatval;
+    if ((cur->nodesetval == NULL) || (cur->nodesetval->nodeNr == 0)) {
+        xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
+    } else {
+        int i = 0;              /* Should be first in document order !!!!! */
 
-    if ((f >= -0.5) && (f < 0.5)) {
-        /* Handles negative zero. */
-        ctxt->value->floatval *= 0.0;
-    }
-    else {
-        double rounded = floor(f);
-        if (f - rounded >= 0.5)
-            rounded += 1.0;
-        ctxt->value->floatval = rounded;
+        switch (cur->nodesetval->nodeTab[i]->type) {
+            case XML_ELEMENT_NODE:
+            case XML_ATTRIBUTE_NODE:
+		if (cur->nodesetval->nodeTab[i]->name[0] == ' ')
+		    xmlXPathValuePush(ctxt,
+			xmlXPathCacheNewCString(ctxt, ""));
+		else if ((cur->nodesetval->nodeTab[i]->ns == NULL) ||
+                         (cur->nodesetval->nodeTab[i]->ns->prefix == NULL)) {
+		    xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt,
+			    cur->nodesetval->nodeTab[i]->name));
+		} else {
+		    xmlChar *fullname;
+
+		    fullname = xmlBuildQName(cur->nodesetval->nodeTab[i]->name,
+				     cur->nodesetval->nodeTab[i]->ns->prefix,
+				     NULL, 0);
+		    if (fullname == cur->nodesetval->nodeTab[i]->name)
+			fullname = xmlStrdup(cur->nodesetval->nodeTab[i]->name);
+		    if (fullname == NULL)
+                        xmlXPathPErrMemory(ctxt);
+		    xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, fullname));
+                }
+                break;
+            default:
+		xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
+		    cur->nodesetval->nodeTab[i]));
+                xmlXPathLocalNameFunction(ctxt, 1);
+        }
     }
+    xmlXPathReleaseObject(ctxt->context, cur);
 }
 
-/************************************************************************
- *									*
- *			The Parser					*
- *									*
- ************************************************************************/
-
-/*
- * a few forward declarations since we use a recursive call based
- * implementation.
- */
-static void xmlXPathCompileExpr(xmlXPathParserContextPtr ctxt, int sort);
-static void xmlXPathCompPredicate(xmlXPathParserContextPtr ctxt, int filter);
-static void xmlXPathCompLocationPath(xmlXPathParserContextPtr ctxt);
-static void xmlXPathCompRelativeLocationPath(xmlXPathParserContextPtr ctxt);
 
 /**
- * Parse an XML non-colonized name.
+ * Implement the string() XPath function
+ *    string string(object?)
+ * The string function converts an object to a string as follows:
+ *    - A node-set is converted to a string by returning the value of
+ *      the node in the node-set that is first in document order.
+ *      If the node-set is empty, an empty string is returned.
+ *    - A number is converted to a string as follows
+ *      + NaN is converted to the string NaN
+ *      + positive zero is converted to the string 0
+ *      + negative zero is converted to the string 0
+ *      + positive infinity is converted to the string Infinity
+ *      + negative infinity is converted to the string -Infinity
+ *      + if the number is an integer, the number is represented in
+ *        decimal form as a Number with no decimal point and no leading
+ *        zeros, preceded by a minus sign (-) if the number is negative
+ *      + otherwise, the number is represented in decimal form as a
+ *        Number including a decimal point with at least one digit
+ *        before the decimal point and at least one digit after the
+ *        decimal point, preceded by a minus sign (-) if the number
+ *        is negative; there must be no leading zeros before the decimal
+ *        point apart possibly from the one required digit immediately
+ *        before the decimal point; beyond the one required digit
+ *        after the decimal point there must be as many, but only as
+ *        many, more digits as are needed to uniquely distinguish the
+ *        number from all other IEEE 754 numeric values.
+ *    - The boolean false value is converted to the string false.
+ *      The boolean true value is converted to the string true.
+ *
+ * If the argument is omitted, it defaults to a node-set with the
+ * context node as its only member.
  *
  * @param ctxt  the XPath Parser context
- * @returns the nc name or NULL
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathStringFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
+    xmlChar *stringval;
 
-xmlChar *
-xmlXPathParseNCName(xmlXPathParserContext *ctxt) {
-    const xmlChar *end;
-    xmlChar *ret;
-
-    if ((ctxt == NULL) || (ctxt->cur == NULL)) return(NULL);
-
-    end = xmlScanName(ctxt->cur, XML_MAX_NAME_LENGTH, XML_SCAN_NC);
-    if (end == NULL) {
-        XP_ERRORNULL(XPATH_EXPR_ERROR);
+    if (ctxt == NULL) return;
+    if (nargs == 0) {
+        stringval = xmlXPathCastNodeToString(ctxt->context->node);
+        if (stringval == NULL)
+            xmlXPathPErrMemory(ctxt);
+        xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, stringval));
+	return;
     }
-    if (end == ctxt->cur)
-        return(NULL);
 
-    ret = xmlStrndup(ctxt->cur, end - ctxt->cur);
-    if (ret == NULL)
-        xmlXPathPErrMemory(ctxt);
-    ctxt->cur = end;
-    return(ret);
+    CHECK_ARITY(1);
+    cur = xmlXPathValuePop(ctxt);
+    if (cur == NULL) XP_ERROR(XPATH_INVALID_OPERAND);
+    if (cur->type != XPATH_STRING) {
+        stringval = xmlXPathCastToString(cur);
+        if (stringval == NULL)
+            xmlXPathPErrMemory(ctxt);
+        xmlXPathReleaseObject(ctxt->context, cur);
+        cur = xmlXPathCacheWrapString(ctxt, stringval);
+    }
+    xmlXPathValuePush(ctxt, cur);
 }
 
-
 /**
- * Parse an XML qualified name
+ * Implement the string-length() XPath function
+ *    number string-length(string?)
+ * The string-length returns the number of characters in the string
+ * (see [3.6 Strings]). If the argument is omitted, it defaults to
+ * the context node converted to a string, in other words the value
+ * of the context node.
  *
  * @param ctxt  the XPath Parser context
- * @param prefix  a xmlChar **
- * @returns the function returns the local part, and prefix is updated
- *   to get the Prefix if any.
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathStringLengthFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
 
-static xmlChar *
-xmlXPathParseQName(xmlXPathParserContextPtr ctxt, xmlChar **prefix) {
-    xmlChar *ret = NULL;
+    if (nargs == 0) {
+        if ((ctxt == NULL) || (ctxt->context == NULL))
+	    return;
+	if (ctxt->context->node == NULL) {
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, 0));
+	} else {
+	    xmlChar *content;
 
-    *prefix = NULL;
-    ret = xmlXPathParseNCName(ctxt);
-    if (ret && CUR == ':') {
-        *prefix = ret;
-	NEXT;
-	ret = xmlXPathParseNCName(ctxt);
+	    content = xmlXPathCastNodeToString(ctxt->context->node);
+            if (content == NULL)
+                xmlXPathPErrMemory(ctxt);
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
+		xmlUTF8Strlen(content)));
+	    xmlFree(content);
+	}
+	return;
     }
-    return(ret);
+    CHECK_ARITY(1);
+    CAST_TO_STRING;
+    CHECK_TYPE(XPATH_STRING);
+    cur = xmlXPathValuePop(ctxt);
+    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt,
+	xmlUTF8Strlen(cur->stringval)));
+    xmlXPathReleaseObject(ctxt->context, cur);
 }
 
 /**
- * parse an XML name
+ * Implement the concat() XPath function
+ *    string concat(string, string, string*)
+ * The concat function returns the concatenation of its arguments.
  *
  * @param ctxt  the XPath Parser context
- * @returns the name or NULL
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathConcatFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur, newobj;
+    xmlChar *tmp;
 
-xmlChar *
-xmlXPathParseName(xmlXPathParserContext *ctxt) {
-    const xmlChar *end;
-    xmlChar *ret;
-
-    if ((ctxt == NULL) || (ctxt->cur == NULL)) return(NULL);
-
-    end = xmlScanName(ctxt->cur, XML_MAX_NAME_LENGTH, 0);
-    if (end == NULL) {
-        XP_ERRORNULL(XPATH_EXPR_ERROR);
-    }
-    if (end == ctxt->cur)
-        return(NULL);
-
-    ret = xmlStrndup(ctxt->cur, end - ctxt->cur);
-    if (ret == NULL)
-        xmlXPathPErrMemory(ctxt);
-    ctxt->cur = end;
-    return(ret);
-}
-
-#define MAX_FRAC 20
-
-/**
- *  [30a]  Float  ::= Number ('e' Digits?)?
- *
- *  [30]   Number ::=   Digits ('.' Digits?)?
- *                    | '.' Digits
- *  [31]   Digits ::=   [0-9]+
- *
- * Compile a Number in the string
- * In complement of the Number expression, this function also handles
- * negative values : '-' Number.
- *
- * @param str  A string to scan
- * @returns the double value.
- */
-double
-xmlXPathStringEvalNumber(const xmlChar *str) {
-    const xmlChar *cur = str;
-    double ret;
-    int ok = 0;
-    int isneg = 0;
-    int exponent = 0;
-    int is_exponent_negative = 0;
-#ifdef __GNUC__
-    unsigned long tmp = 0;
-    double temp;
-#endif
-    if (cur == NULL) return(0);
-    while (IS_BLANK_CH(*cur)) cur++;
-    if (*cur == '-') {
-	isneg = 1;
-	cur++;
-    }
-    if ((*cur != '.') && ((*cur < '0') || (*cur > '9'))) {
-        return(xmlXPathNAN);
+    if (ctxt == NULL) return;
+    if (nargs < 2) {
+	CHECK_ARITY(2);
     }
 
-#ifdef __GNUC__
-    /*
-     * tmp/temp is a workaround against a gcc compiler bug
-     * http://veillard.com/gcc.bug
-     */
-    ret = 0;
-    while ((*cur >= '0') && (*cur <= '9')) {
-	ret = ret * 10;
-	tmp = (*cur - '0');
-	ok = 1;
-	cur++;
-	temp = (double) tmp;
-	ret = ret + temp;
-    }
-#else
-    ret = 0;
-    while ((*cur >= '0') && (*cur <= '9')) {
-	ret = ret * 10 + (*cur - '0');
-	ok = 1;
-	cur++;
+    CAST_TO_STRING;
+    cur = xmlXPathValuePop(ctxt);
+    if ((cur == NULL) || (cur->type != XPATH_STRING)) {
+	xmlXPathReleaseObject(ctxt->context, cur);
+	return;
     }
-#endif
-
-    if (*cur == '.') {
-	int v, frac = 0, max;
-	double fraction = 0;
+    nargs--;
 
-        cur++;
-	if (((*cur < '0') || (*cur > '9')) && (!ok)) {
-	    return(xmlXPathNAN);
-	}
-        while (*cur == '0') {
-	    frac = frac + 1;
-	    cur++;
-        }
-        max = frac + MAX_FRAC;
-	while (((*cur >= '0') && (*cur <= '9')) && (frac < max)) {
-	    v = (*cur - '0');
-	    fraction = fraction * 10 + v;
-	    frac = frac + 1;
-	    cur++;
+    while (nargs > 0) {
+	CAST_TO_STRING;
+	newobj = xmlXPathValuePop(ctxt);
+	if ((newobj == NULL) || (newobj->type != XPATH_STRING)) {
+	    xmlXPathReleaseObject(ctxt->context, newobj);
+	    xmlXPathReleaseObject(ctxt->context, cur);
+	    XP_ERROR(XPATH_INVALID_TYPE);
 	}
-	fraction /= pow(10.0, frac);
-	ret = ret + fraction;
-	while ((*cur >= '0') && (*cur <= '9'))
-	    cur++;
-    }
-    if ((*cur == 'e') || (*cur == 'E')) {
-      cur++;
-      if (*cur == '-') {
-	is_exponent_negative = 1;
-	cur++;
-      } else if (*cur == '+') {
-        cur++;
-      }
-      while ((*cur >= '0') && (*cur <= '9')) {
-        if (exponent < 1000000)
-	  exponent = exponent * 10 + (*cur - '0');
-	cur++;
-      }
+	tmp = xmlStrcat(newobj->stringval, cur->stringval);
+        if (tmp == NULL)
+            xmlXPathPErrMemory(ctxt);
+	newobj->stringval = cur->stringval;
+	cur->stringval = tmp;
+	xmlXPathReleaseObject(ctxt->context, newobj);
+	nargs--;
     }
-    while (IS_BLANK_CH(*cur)) cur++;
-    if (*cur != 0) return(xmlXPathNAN);
-    if (isneg) ret = -ret;
-    if (is_exponent_negative) exponent = -exponent;
-    ret *= pow(10.0, (double)exponent);
-    return(ret);
+    xmlXPathValuePush(ctxt, cur);
 }
 
 /**
- *  [30]   Number ::=   Digits ('.' Digits?)?
- *                    | '.' Digits
- *  [31]   Digits ::=   [0-9]+
- *
- * Compile a Number, then push it on the stack
+ * Implement the contains() XPath function
+ *    boolean contains(string, string)
+ * The contains function returns true if the first argument string
+ * contains the second argument string, and otherwise returns false.
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-static void
-xmlXPathCompNumber(xmlXPathParserContextPtr ctxt)
-{
-    double ret = 0.0;
-    int ok = 0;
-    int exponent = 0;
-    int is_exponent_negative = 0;
-    xmlXPathObjectPtr num;
-#ifdef __GNUC__
-    unsigned long tmp = 0;
-    double temp;
-#endif
+void
+xmlXPathContainsFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr hay, needle;
 
-    CHECK_ERROR;
-    if ((CUR != '.') && ((CUR < '0') || (CUR > '9'))) {
-        XP_ERROR(XPATH_NUMBER_ERROR);
-    }
-#ifdef __GNUC__
-    /*
-     * tmp/temp is a workaround against a gcc compiler bug
-     * http://veillard.com/gcc.bug
-     */
-    ret = 0;
-    while ((CUR >= '0') && (CUR <= '9')) {
-	ret = ret * 10;
-	tmp = (CUR - '0');
-        ok = 1;
-        NEXT;
-	temp = (double) tmp;
-	ret = ret + temp;
-    }
-#else
-    ret = 0;
-    while ((CUR >= '0') && (CUR <= '9')) {
-	ret = ret * 10 + (CUR - '0');
-	ok = 1;
-	NEXT;
-    }
-#endif
-    if (CUR == '.') {
-	int v, frac = 0, max;
-	double fraction = 0;
+    CHECK_ARITY(2);
+    CAST_TO_STRING;
+    CHECK_TYPE(XPATH_STRING);
+    needle = xmlXPathValuePop(ctxt);
+    CAST_TO_STRING;
+    hay = xmlXPathValuePop(ctxt);
 
-        NEXT;
-        if (((CUR < '0') || (CUR > '9')) && (!ok)) {
-            XP_ERROR(XPATH_NUMBER_ERROR);
-        }
-        while (CUR == '0') {
-            frac = frac + 1;
-            NEXT;
-        }
-        max = frac + MAX_FRAC;
-        while ((CUR >= '0') && (CUR <= '9') && (frac < max)) {
-	    v = (CUR - '0');
-	    fraction = fraction * 10 + v;
-	    frac = frac + 1;
-            NEXT;
-        }
-        fraction /= pow(10.0, frac);
-        ret = ret + fraction;
-        while ((CUR >= '0') && (CUR <= '9'))
-            NEXT;
-    }
-    if ((CUR == 'e') || (CUR == 'E')) {
-        NEXT;
-        if (CUR == '-') {
-            is_exponent_negative = 1;
-            NEXT;
-        } else if (CUR == '+') {
-	    NEXT;
-	}
-        while ((CUR >= '0') && (CUR <= '9')) {
-            if (exponent < 1000000)
-                exponent = exponent * 10 + (CUR - '0');
-            NEXT;
-        }
-        if (is_exponent_negative)
-            exponent = -exponent;
-        ret *= pow(10.0, (double) exponent);
-    }
-    num = xmlXPathCacheNewFloat(ctxt, ret);
-    if (num == NULL) {
-	ctxt->error = XPATH_MEMORY_ERROR;
-    } else if (PUSH_LONG_EXPR(XPATH_OP_VALUE, XPATH_NUMBER, 0, 0, num,
-                              NULL) == -1) {
-        xmlXPathReleaseObject(ctxt->context, num);
+    if ((hay == NULL) || (hay->type != XPATH_STRING)) {
+	xmlXPathReleaseObject(ctxt->context, hay);
+	xmlXPathReleaseObject(ctxt->context, needle);
+	XP_ERROR(XPATH_INVALID_TYPE);
     }
+    if (xmlStrstr(hay->stringval, needle->stringval))
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 1));
+    else
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 0));
+    xmlXPathReleaseObject(ctxt->context, hay);
+    xmlXPathReleaseObject(ctxt->context, needle);
 }
 
 /**
- * Parse a Literal
- *
- *  [29]   Literal ::=   '"' [^"]* '"'
- *                    | "'" [^']* "'"
+ * Implement the starts-with() XPath function
+ *    boolean starts-with(string, string)
+ * The starts-with function returns true if the first argument string
+ * starts with the second argument string, and otherwise returns false.
  *
  * @param ctxt  the XPath Parser context
- * @returns the value found or NULL in case of error
+ * @param nargs  the number of arguments
  */
-static xmlChar *
-xmlXPathParseLiteral(xmlXPathParserContextPtr ctxt) {
-    const xmlChar *q;
-    xmlChar *ret = NULL;
-    int quote;
-
-    if (CUR == '"') {
-        quote = '"';
-    } else if (CUR == '\'') {
-        quote = '\'';
-    } else {
-	XP_ERRORNULL(XPATH_START_LITERAL_ERROR);
-    }
+void
+xmlXPathStartsWithFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr hay, needle;
+    int n;
 
-    NEXT;
-    q = CUR_PTR;
-    while (CUR != quote) {
-        int ch;
-        int len = 4;
+    CHECK_ARITY(2);
+    CAST_TO_STRING;
+    CHECK_TYPE(XPATH_STRING);
+    needle = xmlXPathValuePop(ctxt);
+    CAST_TO_STRING;
+    hay = xmlXPathValuePop(ctxt);
 
-        if (CUR == 0)
-            XP_ERRORNULL(XPATH_UNFINISHED_LITERAL_ERROR);
-        ch = xmlGetUTF8Char(CUR_PTR, &len);
-        if ((ch < 0) || (IS_CHAR(ch) == 0))
-            XP_ERRORNULL(XPATH_INVALID_CHAR_ERROR);
-        CUR_PTR += len;
+    if ((hay == NULL) || (hay->type != XPATH_STRING)) {
+	xmlXPathReleaseObject(ctxt->context, hay);
+	xmlXPathReleaseObject(ctxt->context, needle);
+	XP_ERROR(XPATH_INVALID_TYPE);
     }
-    ret = xmlStrndup(q, CUR_PTR - q);
-    if (ret == NULL)
-        xmlXPathPErrMemory(ctxt);
-    NEXT;
-    return(ret);
+    n = xmlStrlen(needle->stringval);
+    if (xmlStrncmp(hay->stringval, needle->stringval, n))
+        xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 0));
+    else
+        xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 1));
+    xmlXPathReleaseObject(ctxt->context, hay);
+    xmlXPathReleaseObject(ctxt->context, needle);
 }
 
 /**
- * Parse a Literal and push it on the stack.
- *
- *  [29]   Literal ::=   '"' [^"]* '"'
- *                    | "'" [^']* "'"
- *
- * TODO: Memory allocation could be improved.
+ * Implement the substring() XPath function
+ *    string substring(string, number, number?)
+ * The substring function returns the substring of the first argument
+ * starting at the position specified in the second argument with
+ * length specified in the third argument. For example,
+ * substring("12345",2,3) returns "234". If the third argument is not
+ * specified, it returns the substring starting at the position specified
+ * in the second argument and continuing to the end of the string. For
+ * example, substring("12345",2) returns "2345".  More precisely, each
+ * character in the string (see [3.6 Strings]) is considered to have a
+ * numeric position: the position of the first character is 1, the position
+ * of the second character is 2 and so on. The returned substring contains
+ * those characters for which the position of the character is greater than
+ * or equal to the second argument and, if the third argument is specified,
+ * less than the sum of the second and third arguments; the comparisons
+ * and addition used for the above follow the standard IEEE 754 rules. Thus:
+ *  - substring("12345", 1.5, 2.6) returns "234"
+ *  - substring("12345", 0, 3) returns "12"
+ *  - substring("12345", 0 div 0, 3) returns ""
+ *  - substring("12345", 1, 0 div 0) returns ""
+ *  - substring("12345", -42, 1 div 0) returns "12345"
+ *  - substring("12345", -1 div 0, 1 div 0) returns ""
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-static void
-xmlXPathCompLiteral(xmlXPathParserContextPtr ctxt) {
-    xmlChar *ret = NULL;
-    xmlXPathObjectPtr lit;
+void
+xmlXPathSubstringFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr str, start, len;
+    double le=0, in;
+    int i = 1, j = INT_MAX;
 
-    ret = xmlXPathParseLiteral(ctxt);
-    if (ret == NULL)
-        return;
-    lit = xmlXPathCacheNewString(ctxt, ret);
-    if (lit == NULL) {
-        ctxt->error = XPATH_MEMORY_ERROR;
-    } else if (PUSH_LONG_EXPR(XPATH_OP_VALUE, XPATH_STRING, 0, 0, lit,
-                              NULL) == -1) {
-        xmlXPathReleaseObject(ctxt->context, lit);
+    if (nargs < 2) {
+	CHECK_ARITY(2);
+    }
+    if (nargs > 3) {
+	CHECK_ARITY(3);
+    }
+    /*
+     * take care of possible last (position) argument
+    */
+    if (nargs == 3) {
+	CAST_TO_NUMBER;
+	CHECK_TYPE(XPATH_NUMBER);
+	len = xmlXPathValuePop(ctxt);
+	le = len->floatval;
+	xmlXPathReleaseObject(ctxt->context, len);
     }
-    xmlFree(ret);
-}
 
-/**
- * Parse a VariableReference, evaluate it and push it on the stack.
- *
- * The variable bindings consist of a mapping from variable names
- * to variable values. The value of a variable is an object, which can be
- * of any of the types that are possible for the value of an expression,
- * and may also be of additional types not specified here.
- *
- * Early evaluation is possible since:
- * The variable bindings [...] used to evaluate a subexpression are
- * always the same as those used to evaluate the containing expression.
- *
- *  [36]   VariableReference ::=   '$' QName
- * @param ctxt  the XPath Parser context
- */
-static void
-xmlXPathCompVariableReference(xmlXPathParserContextPtr ctxt) {
-    xmlChar *name;
-    xmlChar *prefix;
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+    start = xmlXPathValuePop(ctxt);
+    in = start->floatval;
+    xmlXPathReleaseObject(ctxt->context, start);
+    CAST_TO_STRING;
+    CHECK_TYPE(XPATH_STRING);
+    str = xmlXPathValuePop(ctxt);
 
-    SKIP_BLANKS;
-    if (CUR != '$') {
-	XP_ERROR(XPATH_VARIABLE_REF_ERROR);
-    }
-    NEXT;
-    name = xmlXPathParseQName(ctxt, &prefix);
-    if (name == NULL) {
-        xmlFree(prefix);
-	XP_ERROR(XPATH_VARIABLE_REF_ERROR);
+    if (!(in < INT_MAX)) { /* Logical NOT to handle NaNs */
+        i = INT_MAX;
+    } else if (in >= 1.0) {
+        i = (int)in;
+        if (in - floor(in) >= 0.5)
+            i += 1;
     }
-    ctxt->comp->last = -1;
-    if (PUSH_LONG_EXPR(XPATH_OP_VARIABLE, 0, 0, 0, name, prefix) == -1) {
-        xmlFree(prefix);
-        xmlFree(name);
+
+    if (nargs == 3) {
+        double rin, rle, end;
+
+        rin = floor(in);
+        if (in - rin >= 0.5)
+            rin += 1.0;
+
+        rle = floor(le);
+        if (le - rle >= 0.5)
+            rle += 1.0;
+
+        end = rin + rle;
+        if (!(end >= 1.0)) { /* Logical NOT to handle NaNs */
+            j = 1;
+        } else if (end < INT_MAX) {
+            j = (int)end;
+        }
     }
-    SKIP_BLANKS;
-    if ((ctxt->context != NULL) && (ctxt->context->flags & XML_XPATH_NOVAR)) {
-	XP_ERROR(XPATH_FORBID_VARIABLE_ERROR);
+
+    i -= 1;
+    j -= 1;
+
+    if ((i < j) && (i < xmlUTF8Strlen(str->stringval))) {
+        xmlChar *ret = xmlUTF8Strsub(str->stringval, i, j - i);
+        if (ret == NULL)
+            xmlXPathPErrMemory(ctxt);
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewString(ctxt, ret));
+	xmlFree(ret);
+    } else {
+	xmlXPathValuePush(ctxt, xmlXPathCacheNewCString(ctxt, ""));
     }
+
+    xmlXPathReleaseObject(ctxt->context, str);
 }
 
 /**
- * Is the name given a NodeType one.
- *
- *  [38]   NodeType ::=   'comment'
- *                    | 'text'
- *                    | 'processing-instruction'
- *                    | 'node'
+ * Implement the substring-before() XPath function
+ *    string substring-before(string, string)
+ * The substring-before function returns the substring of the first
+ * argument string that precedes the first occurrence of the second
+ * argument string in the first argument string, or the empty string
+ * if the first argument string does not contain the second argument
+ * string. For example, substring-before("1999/04/01","/") returns 1999.
  *
- * @param name  a name string
- * @returns 1 if true 0 otherwise
+ * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-int
-xmlXPathIsNodeType(const xmlChar *name) {
-    if (name == NULL)
-	return(0);
+void
+xmlXPathSubstringBeforeFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr str = NULL;
+    xmlXPathObjectPtr find = NULL;
+    const xmlChar *point;
+    xmlChar *result;
 
-    if (xmlStrEqual(name, BAD_CAST "node"))
-	return(1);
-    if (xmlStrEqual(name, BAD_CAST "text"))
-	return(1);
-    if (xmlStrEqual(name, BAD_CAST "comment"))
-	return(1);
-    if (xmlStrEqual(name, BAD_CAST "processing-instruction"))
-	return(1);
-    return(0);
+    CHECK_ARITY(2);
+    CAST_TO_STRING;
+    find = xmlXPathValuePop(ctxt);
+    CAST_TO_STRING;
+    str = xmlXPathValuePop(ctxt);
+    if (ctxt->error != 0)
+        goto error;
+
+    point = xmlStrstr(str->stringval, find->stringval);
+    if (point == NULL) {
+        result = xmlStrdup(BAD_CAST "");
+    } else {
+        result = xmlStrndup(str->stringval, point - str->stringval);
+    }
+    if (result == NULL) {
+        xmlXPathPErrMemory(ctxt);
+        goto error;
+    }
+    xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, result));
+
+error:
+    xmlXPathReleaseObject(ctxt->context, str);
+    xmlXPathReleaseObject(ctxt->context, find);
 }
 
 /**
- *  [16]   FunctionCall ::=   FunctionName '(' ( Argument ( ',' Argument)*)? ')'
- *  [17]   Argument ::=   Expr
- *
- * Compile a function call, the evaluation of all arguments are
- * pushed on the stack
+ * Implement the substring-after() XPath function
+ *    string substring-after(string, string)
+ * The substring-after function returns the substring of the first
+ * argument string that follows the first occurrence of the second
+ * argument string in the first argument string, or the empty string
+ * if the first argument string does not contain the second argument
+ * string. For example, substring-after("1999/04/01","/") returns 04/01,
+ * and substring-after("1999/04/01","19") returns 99/04/01.
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-static void
-xmlXPathCompFunctionCall(xmlXPathParserContextPtr ctxt) {
-    xmlChar *name;
-    xmlChar *prefix;
-    int nbargs = 0;
-    int sort = 1;
-
-    name = xmlXPathParseQName(ctxt, &prefix);
-    if (name == NULL) {
-	xmlFree(prefix);
-	XP_ERROR(XPATH_EXPR_ERROR);
-    }
-    SKIP_BLANKS;
+void
+xmlXPathSubstringAfterFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr str = NULL;
+    xmlXPathObjectPtr find = NULL;
+    const xmlChar *point;
+    xmlChar *result;
 
-    if (CUR != '(') {
-	xmlFree(name);
-	xmlFree(prefix);
-	XP_ERROR(XPATH_EXPR_ERROR);
-    }
-    NEXT;
-    SKIP_BLANKS;
+    CHECK_ARITY(2);
+    CAST_TO_STRING;
+    find = xmlXPathValuePop(ctxt);
+    CAST_TO_STRING;
+    str = xmlXPathValuePop(ctxt);
+    if (ctxt->error != 0)
+        goto error;
 
-    /*
-    * Optimization for count(): we don't need the node-set to be sorted.
-    */
-    if ((prefix == NULL) && (name[0] == 'c') &&
-	xmlStrEqual(name, BAD_CAST "count"))
-    {
-	sort = 0;
-    }
-    ctxt->comp->last = -1;
-    if (CUR != ')') {
-	while (CUR != 0) {
-	    int op1 = ctxt->comp->last;
-	    ctxt->comp->last = -1;
-	    xmlXPathCompileExpr(ctxt, sort);
-	    if (ctxt->error != XPATH_EXPRESSION_OK) {
-		xmlFree(name);
-		xmlFree(prefix);
-		return;
-	    }
-	    PUSH_BINARY_EXPR(XPATH_OP_ARG, op1, ctxt->comp->last, 0, 0);
-	    nbargs++;
-	    if (CUR == ')') break;
-	    if (CUR != ',') {
-		xmlFree(name);
-		xmlFree(prefix);
-		XP_ERROR(XPATH_EXPR_ERROR);
-	    }
-	    NEXT;
-	    SKIP_BLANKS;
-	}
+    point = xmlStrstr(str->stringval, find->stringval);
+    if (point == NULL) {
+        result = xmlStrdup(BAD_CAST "");
+    } else {
+        result = xmlStrdup(point + xmlStrlen(find->stringval));
     }
-    if (PUSH_LONG_EXPR(XPATH_OP_FUNCTION, nbargs, 0, 0, name, prefix) == -1) {
-        xmlFree(prefix);
-        xmlFree(name);
+    if (result == NULL) {
+        xmlXPathPErrMemory(ctxt);
+        goto error;
     }
-    NEXT;
-    SKIP_BLANKS;
-}
+    xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, result));
 
-/**
- *  [15]   PrimaryExpr ::=   VariableReference
- *                | '(' Expr ')'
- *                | Literal
- *                | Number
- *                | FunctionCall
- *
- * Compile a primary expression.
- *
- * @param ctxt  the XPath Parser context
- */
-static void
-xmlXPathCompPrimaryExpr(xmlXPathParserContextPtr ctxt) {
-    SKIP_BLANKS;
-    if (CUR == '$') xmlXPathCompVariableReference(ctxt);
-    else if (CUR == '(') {
-	NEXT;
-	SKIP_BLANKS;
-	xmlXPathCompileExpr(ctxt, 1);
-	CHECK_ERROR;
-	if (CUR != ')') {
-	    XP_ERROR(XPATH_EXPR_ERROR);
-	}
-	NEXT;
-	SKIP_BLANKS;
-    } else if (IS_ASCII_DIGIT(CUR) || (CUR == '.' && IS_ASCII_DIGIT(NXT(1)))) {
-	xmlXPathCompNumber(ctxt);
-    } else if ((CUR == '\'') || (CUR == '"')) {
-	xmlXPathCompLiteral(ctxt);
-    } else {
-	xmlXPathCompFunctionCall(ctxt);
-    }
-    SKIP_BLANKS;
+error:
+    xmlXPathReleaseObject(ctxt->context, str);
+    xmlXPathReleaseObject(ctxt->context, find);
 }
 
 /**
- *  [20]   FilterExpr ::=   PrimaryExpr
- *               | FilterExpr Predicate
- *
- * Compile a filter expression.
- * Square brackets are used to filter expressions in the same way that
- * they are used in location paths. It is an error if the expression to
- * be filtered does not evaluate to a node-set. The context node list
- * used for evaluating the expression in square brackets is the node-set
- * to be filtered listed in document order.
+ * Implement the normalize-space() XPath function
+ *    string normalize-space(string?)
+ * The normalize-space function returns the argument string with white
+ * space normalized by stripping leading and trailing whitespace
+ * and replacing sequences of whitespace characters by a single
+ * space. Whitespace characters are the same allowed by the S production
+ * in XML. If the argument is omitted, it defaults to the context
+ * node converted to a string, in other words the value of the context node.
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathNormalizeFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlChar *source, *target;
+    int blank;
 
-static void
-xmlXPathCompFilterExpr(xmlXPathParserContextPtr ctxt) {
-    xmlXPathCompPrimaryExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-
-    while (CUR == '[') {
-	xmlXPathCompPredicate(ctxt, 1);
-	SKIP_BLANKS;
+    if (ctxt == NULL) return;
+    if (nargs == 0) {
+        /* Use current context node */
+        source = xmlXPathCastNodeToString(ctxt->context->node);
+        if (source == NULL)
+            xmlXPathPErrMemory(ctxt);
+        xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, source));
+        nargs = 1;
     }
 
+    CHECK_ARITY(1);
+    CAST_TO_STRING;
+    CHECK_TYPE(XPATH_STRING);
+    source = ctxt->value->stringval;
+    if (source == NULL)
+        return;
+    target = source;
+
+    /* Skip leading whitespaces */
+    while (IS_BLANK_CH(*source))
+        source++;
 
+    /* Collapse intermediate whitespaces, and skip trailing whitespaces */
+    blank = 0;
+    while (*source) {
+        if (IS_BLANK_CH(*source)) {
+	    blank = 1;
+        } else {
+            if (blank) {
+                *target++ = 0x20;
+                blank = 0;
+            }
+            *target++ = *source;
+        }
+        source++;
+    }
+    *target = 0;
 }
 
 /**
- * Trickery: parse an XML name but without consuming the input flow
- * Needed to avoid insanity in the parser state.
+ * Implement the translate() XPath function
+ *    string translate(string, string, string)
+ * The translate function returns the first argument string with
+ * occurrences of characters in the second argument string replaced
+ * by the character at the corresponding position in the third argument
+ * string. For example, translate("bar","abc","ABC") returns the string
+ * BAr. If there is a character in the second argument string with no
+ * character at a corresponding position in the third argument string
+ * (because the second argument string is longer than the third argument
+ * string), then occurrences of that character in the first argument
+ * string are removed. For example,
+ * translate("--aaa--","abc-","ABC") returns "AAA".
+ * If a character occurs more than once in second
+ * argument string, then the first occurrence determines the replacement
+ * character. If the third argument string is longer than the second
+ * argument string, then excess characters are ignored.
  *
  * @param ctxt  the XPath Parser context
- * @returns the Name parsed or NULL
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathTranslateFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr str = NULL;
+    xmlXPathObjectPtr from = NULL;
+    xmlXPathObjectPtr to = NULL;
+    xmlBufPtr target;
+    int offset, max;
+    int ch;
+    const xmlChar *point;
+    xmlChar *cptr, *content;
 
-static xmlChar *
-xmlXPathScanName(xmlXPathParserContextPtr ctxt) {
-    const xmlChar *end;
-    xmlChar *ret;
+    CHECK_ARITY(3);
 
-    end = xmlScanName(ctxt->cur, XML_MAX_NAME_LENGTH, 0);
-    if (end == NULL) {
-        XP_ERRORNULL(XPATH_EXPR_ERROR);
+    CAST_TO_STRING;
+    to = xmlXPathValuePop(ctxt);
+    CAST_TO_STRING;
+    from = xmlXPathValuePop(ctxt);
+    CAST_TO_STRING;
+    str = xmlXPathValuePop(ctxt);
+    if (ctxt->error != 0)
+        goto error;
+
+    /*
+     * Account for quadratic runtime
+     */
+    if (XP_HAS_LIMITS(ctxt->context)) {
+        unsigned long f1 = xmlStrlen(from->stringval);
+        unsigned long f2 = xmlStrlen(str->stringval);
+
+        if ((f1 > 0) && (f2 > 0)) {
+            unsigned long p;
+
+            f1 = f1 / 10 + 1;
+            f2 = f2 / 10 + 1;
+            p = f1 > ULONG_MAX / f2 ? ULONG_MAX : f1 * f2;
+            if (xmlXPathCheckOpLimit(ctxt, p) < 0)
+                goto error;
+        }
     }
-    if (end == ctxt->cur)
-        return(NULL);
 
-    ret = xmlStrndup(ctxt->cur, end - ctxt->cur);
-    if (ret == NULL)
+    target = xmlBufCreate(50);
+    if (target == NULL) {
         xmlXPathPErrMemory(ctxt);
-    return(ret);
-}
-
-/**
- *  [19]   PathExpr ::=   LocationPath
- *               | FilterExpr
- *               | FilterExpr '/' RelativeLocationPath
- *               | FilterExpr '//' RelativeLocationPath
- *
- * Compile a path expression.
- *
- * @param ctxt  the XPath Parser context
- */
-
-static void
-xmlXPathCompPathExpr(xmlXPathParserContextPtr ctxt) {
-    int lc = 1;           /* Should we branch to LocationPath ?         */
-    xmlChar *name = NULL; /* we may have to preparse a name to find out */
-
-    SKIP_BLANKS;
-    if ((CUR == '$') || (CUR == '(') ||
-	(IS_ASCII_DIGIT(CUR)) ||
-        (CUR == '\'') || (CUR == '"') ||
-	(CUR == '.' && IS_ASCII_DIGIT(NXT(1)))) {
-	lc = 0;
-    } else if (CUR == '*') {
-	/* relative or absolute location path */
-	lc = 1;
-    } else if (CUR == '/') {
-	/* relative or absolute location path */
-	lc = 1;
-    } else if (CUR == '@') {
-	/* relative abbreviated attribute location path */
-	lc = 1;
-    } else if (CUR == '.') {
-	/* relative abbreviated attribute location path */
-	lc = 1;
-    } else {
-	/*
-	 * Problem is finding if we have a name here whether it's:
-	 *   - a nodetype
-	 *   - a function call in which case it's followed by '('
-	 *   - an axis in which case it's followed by ':'
-	 *   - a element name
-	 * We do an a priori analysis here rather than having to
-	 * maintain parsed token content through the recursive function
-	 * calls. This looks uglier but makes the code easier to
-	 * read/write/debug.
-	 */
-	SKIP_BLANKS;
-	name = xmlXPathScanName(ctxt);
-	if ((name != NULL) && (xmlStrstr(name, (xmlChar *) "::") != NULL)) {
-	    lc = 1;
-	    xmlFree(name);
-	} else if (name != NULL) {
-	    int len =xmlStrlen(name);
+        goto error;
+    }
 
+    max = xmlUTF8Strlen(to->stringval);
+    for (cptr = str->stringval; (ch=*cptr); ) {
+        offset = xmlUTF8Strloc(from->stringval, cptr);
+        if (offset >= 0) {
+            if (offset < max) {
+                point = xmlUTF8Strpos(to->stringval, offset);
+                if (point)
+                    xmlBufAdd(target, point, xmlUTF8Strsize(point, 1));
+            }
+        } else
+            xmlBufAdd(target, cptr, xmlUTF8Strsize(cptr, 1));
 
-	    while (NXT(len) != 0) {
-		if (NXT(len) == '/') {
-		    /* element name */
-		    lc = 1;
-		    break;
-		} else if (IS_BLANK_CH(NXT(len))) {
-		    /* ignore blanks */
-		    ;
-		} else if (NXT(len) == ':') {
-		    lc = 1;
-		    break;
-		} else if ((NXT(len) == '(')) {
-		    /* Node Type or Function */
-		    if (xmlXPathIsNodeType(name)) {
-			lc = 1;
-		    } else {
-			lc = 0;
-		    }
+        /* Step to next character in input */
+        cptr++;
+        if ( ch & 0x80 ) {
+            /* if not simple ascii, verify proper format */
+            if ( (ch & 0xc0) != 0xc0 ) {
+                xmlXPathErr(ctxt, XPATH_INVALID_CHAR_ERROR);
+                break;
+            }
+            /* then skip over remaining bytes for this char */
+            while ( (ch <<= 1) & 0x80 )
+                if ( (*cptr++ & 0xc0) != 0x80 ) {
+                    xmlXPathErr(ctxt, XPATH_INVALID_CHAR_ERROR);
                     break;
-		} else if ((NXT(len) == '[')) {
-		    /* element name */
-		    lc = 1;
-		    break;
-		} else if ((NXT(len) == '<') || (NXT(len) == '>') ||
-			   (NXT(len) == '=')) {
-		    lc = 1;
-		    break;
-		} else {
-		    lc = 1;
-		    break;
-		}
-		len++;
-	    }
-	    if (NXT(len) == 0) {
-		/* element name */
-		lc = 1;
-	    }
-	    xmlFree(name);
-	} else {
-	    /* make sure all cases are covered explicitly */
-	    XP_ERROR(XPATH_EXPR_ERROR);
-	}
+                }
+            if (ch & 0x80) /* must have had error encountered */
+                break;
+        }
     }
 
-    if (lc) {
-	if (CUR == '/') {
-	    PUSH_LEAVE_EXPR(XPATH_OP_ROOT, 0, 0);
-	} else {
-	    PUSH_LEAVE_EXPR(XPATH_OP_NODE, 0, 0);
-	}
-	xmlXPathCompLocationPath(ctxt);
-    } else {
-	xmlXPathCompFilterExpr(ctxt);
-	CHECK_ERROR;
-	if ((CUR == '/') && (NXT(1) == '/')) {
-	    SKIP(2);
-	    SKIP_BLANKS;
-
-	    PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
-		    NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
-
-	    xmlXPathCompRelativeLocationPath(ctxt);
-	} else if (CUR == '/') {
-	    xmlXPathCompRelativeLocationPath(ctxt);
-	}
-    }
-    SKIP_BLANKS;
+    content = xmlBufDetach(target);
+    if (content == NULL)
+        xmlXPathPErrMemory(ctxt);
+    else
+        xmlXPathValuePush(ctxt, xmlXPathCacheWrapString(ctxt, content));
+    xmlBufFree(target);
+error:
+    xmlXPathReleaseObject(ctxt->context, str);
+    xmlXPathReleaseObject(ctxt->context, from);
+    xmlXPathReleaseObject(ctxt->context, to);
 }
 
 /**
- *  [18]   UnionExpr ::=   PathExpr
- *               | UnionExpr '|' PathExpr
- *
- * Compile an union expression.
+ * Implement the boolean() XPath function
+ *    boolean boolean(object)
+ * The boolean function converts its argument to a boolean as follows:
+ *    - a number is true if and only if it is neither positive or
+ *      negative zero nor NaN
+ *    - a node-set is true if and only if it is non-empty
+ *    - a string is true if and only if its length is non-zero
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathBooleanFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
 
-static void
-xmlXPathCompUnionExpr(xmlXPathParserContextPtr ctxt) {
-    xmlXPathCompPathExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while (CUR == '|') {
-	int op1 = ctxt->comp->last;
-	PUSH_LEAVE_EXPR(XPATH_OP_NODE, 0, 0);
-
-	NEXT;
-	SKIP_BLANKS;
-	xmlXPathCompPathExpr(ctxt);
-
-	PUSH_BINARY_EXPR(XPATH_OP_UNION, op1, ctxt->comp->last, 0, 0);
+    CHECK_ARITY(1);
+    cur = xmlXPathValuePop(ctxt);
+    if (cur == NULL) XP_ERROR(XPATH_INVALID_OPERAND);
+    if (cur->type != XPATH_BOOLEAN) {
+        int boolval = xmlXPathCastToBoolean(cur);
 
-	SKIP_BLANKS;
+        xmlXPathReleaseObject(ctxt->context, cur);
+        cur = xmlXPathCacheNewBoolean(ctxt, boolval);
     }
+    xmlXPathValuePush(ctxt, cur);
 }
 
 /**
- *  [27]   UnaryExpr ::=   UnionExpr
- *                   | '-' UnaryExpr
- *
- * Compile an unary expression.
+ * Implement the not() XPath function
+ *    boolean not(boolean)
+ * The not function returns true if its argument is false,
+ * and false otherwise.
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-
-static void
-xmlXPathCompUnaryExpr(xmlXPathParserContextPtr ctxt) {
-    int minus = 0;
-    int found = 0;
-
-    SKIP_BLANKS;
-    while (CUR == '-') {
-        minus = 1 - minus;
-	found = 1;
-	NEXT;
-	SKIP_BLANKS;
-    }
-
-    xmlXPathCompUnionExpr(ctxt);
-    CHECK_ERROR;
-    if (found) {
-	if (minus)
-	    PUSH_UNARY_EXPR(XPATH_OP_PLUS, ctxt->comp->last, 2, 0);
-	else
-	    PUSH_UNARY_EXPR(XPATH_OP_PLUS, ctxt->comp->last, 3, 0);
-    }
+void
+xmlXPathNotFunction(xmlXPathParserContext *ctxt, int nargs) {
+    CHECK_ARITY(1);
+    CAST_TO_BOOLEAN;
+    CHECK_TYPE(XPATH_BOOLEAN);
+    ctxt->value->boolval = ! ctxt->value->boolval;
 }
 
 /**
- *  [26]   MultiplicativeExpr ::=   UnaryExpr
- *                   | MultiplicativeExpr MultiplyOperator UnaryExpr
- *                   | MultiplicativeExpr 'div' UnaryExpr
- *                   | MultiplicativeExpr 'mod' UnaryExpr
- *  [34]   MultiplyOperator ::=   '*'
+ * Implement the true() XPath function
+ *    boolean true()
  *
- * Compile an Additive expression.
+ * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
+ */
+void
+xmlXPathTrueFunction(xmlXPathParserContext *ctxt, int nargs) {
+    CHECK_ARITY(0);
+    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 1));
+}
+
+/**
+ * Implement the false() XPath function
+ *    boolean false()
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-
-static void
-xmlXPathCompMultiplicativeExpr(xmlXPathParserContextPtr ctxt) {
-    xmlXPathCompUnaryExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while ((CUR == '*') ||
-           ((CUR == 'd') && (NXT(1) == 'i') && (NXT(2) == 'v')) ||
-           ((CUR == 'm') && (NXT(1) == 'o') && (NXT(2) == 'd'))) {
-	int op = -1;
-	int op1 = ctxt->comp->last;
-
-        if (CUR == '*') {
-	    op = 0;
-	    NEXT;
-	} else if (CUR == 'd') {
-	    op = 1;
-	    SKIP(3);
-	} else if (CUR == 'm') {
-	    op = 2;
-	    SKIP(3);
-	}
-	SKIP_BLANKS;
-        xmlXPathCompUnaryExpr(ctxt);
-	CHECK_ERROR;
-	PUSH_BINARY_EXPR(XPATH_OP_MULT, op1, ctxt->comp->last, op, 0);
-	SKIP_BLANKS;
-    }
-}
+void
+xmlXPathFalseFunction(xmlXPathParserContext *ctxt, int nargs) {
+    CHECK_ARITY(0);
+    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, 0));
+}
 
 /**
- *  [25]   AdditiveExpr ::=   MultiplicativeExpr
- *                   | AdditiveExpr '+' MultiplicativeExpr
- *                   | AdditiveExpr '-' MultiplicativeExpr
- *
- * Compile an Additive expression.
+ * Implement the lang() XPath function
+ *    boolean lang(string)
+ * The lang function returns true or false depending on whether the
+ * language of the context node as specified by xml:lang attributes
+ * is the same as or is a sublanguage of the language specified by
+ * the argument string. The language of the context node is determined
+ * by the value of the xml:lang attribute on the context node, or, if
+ * the context node has no xml:lang attribute, by the value of the
+ * xml:lang attribute on the nearest ancestor of the context node that
+ * has an xml:lang attribute. If there is no such attribute, then
+ * lang returns false. If there is such an attribute, then lang returns
+ * true if the attribute value is equal to the argument ignoring case,
+ * or if there is some suffix starting with - such that the attribute
+ * value is equal to the argument ignoring that suffix of the attribute
+ * value and ignoring case.
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathLangFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr val;
+    xmlNodePtr cur;
+    xmlChar *theLang;
+    const xmlChar *lang;
+    int ret = 0;
+    int i;
 
-static void
-xmlXPathCompAdditiveExpr(xmlXPathParserContextPtr ctxt) {
-
-    xmlXPathCompMultiplicativeExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while ((CUR == '+') || (CUR == '-')) {
-	int plus;
-	int op1 = ctxt->comp->last;
-
-        if (CUR == '+') plus = 1;
-	else plus = 0;
-	NEXT;
-	SKIP_BLANKS;
-        xmlXPathCompMultiplicativeExpr(ctxt);
-	CHECK_ERROR;
-	PUSH_BINARY_EXPR(XPATH_OP_PLUS, op1, ctxt->comp->last, plus, 0);
-	SKIP_BLANKS;
+    CHECK_ARITY(1);
+    CAST_TO_STRING;
+    CHECK_TYPE(XPATH_STRING);
+    val = xmlXPathValuePop(ctxt);
+    lang = val->stringval;
+    cur = ctxt->context->node;
+    while (cur != NULL) {
+        if (xmlNodeGetAttrValue(cur, BAD_CAST "lang", XML_XML_NAMESPACE,
+                                &theLang) < 0)
+            xmlXPathPErrMemory(ctxt);
+        if (theLang != NULL)
+            break;
+        cur = cur->parent;
     }
+    if ((theLang != NULL) && (lang != NULL)) {
+        for (i = 0;lang[i] != 0;i++)
+            if (toupper(lang[i]) != toupper(theLang[i]))
+                goto not_equal;
+        if ((theLang[i] == 0) || (theLang[i] == '-'))
+            ret = 1;
+    }
+not_equal:
+    if (theLang != NULL)
+	xmlFree((void *)theLang);
+
+    xmlXPathReleaseObject(ctxt->context, val);
+    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, ret));
 }
 
 /**
- *  [24]   RelationalExpr ::=   AdditiveExpr
- *                 | RelationalExpr '<' AdditiveExpr
- *                 | RelationalExpr '>' AdditiveExpr
- *                 | RelationalExpr '<=' AdditiveExpr
- *                 | RelationalExpr '>=' AdditiveExpr
- *
- *  A <= B > C is allowed ? Answer from James, yes with
- *  (AdditiveExpr <= AdditiveExpr) > AdditiveExpr
- *  which is basically what got implemented.
- *
- * Compile a Relational expression, then push the result
- * on the stack
+ * Implement the number() XPath function
+ *    number number(object?)
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
+void
+xmlXPathNumberFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
+    double res;
 
-static void
-xmlXPathCompRelationalExpr(xmlXPathParserContextPtr ctxt) {
-    xmlXPathCompAdditiveExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while ((CUR == '<') || (CUR == '>')) {
-	int inf, strict;
-	int op1 = ctxt->comp->last;
+    if (ctxt == NULL) return;
+    if (nargs == 0) {
+	if (ctxt->context->node == NULL) {
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, 0.0));
+	} else {
+	    xmlChar* content = xmlNodeGetContent(ctxt->context->node);
+            if (content == NULL)
+                xmlXPathPErrMemory(ctxt);
 
-        if (CUR == '<') inf = 1;
-	else inf = 0;
-	if (NXT(1) == '=') strict = 0;
-	else strict = 1;
-	NEXT;
-	if (!strict) NEXT;
-	SKIP_BLANKS;
-        xmlXPathCompAdditiveExpr(ctxt);
-	CHECK_ERROR;
-	PUSH_BINARY_EXPR(XPATH_OP_CMP, op1, ctxt->comp->last, inf, strict);
-	SKIP_BLANKS;
+	    res = xmlXPathStringEvalNumber(content);
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, res));
+	    xmlFree(content);
+	}
+	return;
+    }
+
+    CHECK_ARITY(1);
+    cur = xmlXPathValuePop(ctxt);
+    if (cur->type != XPATH_NUMBER) {
+        double floatval;
+
+        floatval = xmlXPathCastToNumberInternal(ctxt, cur);
+        xmlXPathReleaseObject(ctxt->context, cur);
+        cur = xmlXPathCacheNewFloat(ctxt, floatval);
     }
+    xmlXPathValuePush(ctxt, cur);
 }
 
 /**
- *  [23]   EqualityExpr ::=   RelationalExpr
- *                 | EqualityExpr '=' RelationalExpr
- *                 | EqualityExpr '!=' RelationalExpr
- *
- *  A != B != C is allowed ? Answer from James, yes with
- *  (RelationalExpr = RelationalExpr) = RelationalExpr
- *  (RelationalExpr != RelationalExpr) != RelationalExpr
- *  which is basically what got implemented.
- *
- * Compile an Equality expression.
+ * Implement the sum() XPath function
+ *    number sum(node-set)
+ * The sum function returns the sum of the values of the nodes in
+ * the argument node-set.
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-static void
-xmlXPathCompEqualityExpr(xmlXPathParserContextPtr ctxt) {
-    xmlXPathCompRelationalExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while ((CUR == '=') || ((CUR == '!') && (NXT(1) == '='))) {
-	int eq;
-	int op1 = ctxt->comp->last;
+void
+xmlXPathSumFunction(xmlXPathParserContext *ctxt, int nargs) {
+    xmlXPathObjectPtr cur;
+    int i;
+    double res = 0.0;
 
-        if (CUR == '=') eq = 1;
-	else eq = 0;
-	NEXT;
-	if (!eq) NEXT;
-	SKIP_BLANKS;
-        xmlXPathCompRelationalExpr(ctxt);
-	CHECK_ERROR;
-	PUSH_BINARY_EXPR(XPATH_OP_EQUAL, op1, ctxt->comp->last, eq, 0);
-	SKIP_BLANKS;
+    CHECK_ARITY(1);
+    if ((ctxt->value == NULL) ||
+	((ctxt->value->type != XPATH_NODESET) &&
+	 (ctxt->value->type != XPATH_XSLT_TREE)))
+	XP_ERROR(XPATH_INVALID_TYPE);
+    cur = xmlXPathValuePop(ctxt);
+
+    if ((cur->nodesetval != NULL) && (cur->nodesetval->nodeNr != 0)) {
+	for (i = 0; i < cur->nodesetval->nodeNr; i++) {
+	    res += xmlXPathNodeToNumberInternal(ctxt,
+                                                cur->nodesetval->nodeTab[i]);
+	}
     }
+    xmlXPathValuePush(ctxt, xmlXPathCacheNewFloat(ctxt, res));
+    xmlXPathReleaseObject(ctxt->context, cur);
 }
 
 /**
- *  [22]   AndExpr ::=   EqualityExpr
- *                 | AndExpr 'and' EqualityExpr
- *
- * Compile an AND expression.
+ * Implement the floor() XPath function
+ *    number floor(number)
+ * The floor function returns the largest (closest to positive infinity)
+ * number that is not greater than the argument and that is an integer.
  *
  * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
  */
-static void
-xmlXPathCompAndExpr(xmlXPathParserContextPtr ctxt) {
-    xmlXPathCompEqualityExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while ((CUR == 'a') && (NXT(1) == 'n') && (NXT(2) == 'd')) {
-	int op1 = ctxt->comp->last;
-        SKIP(3);
-	SKIP_BLANKS;
-        xmlXPathCompEqualityExpr(ctxt);
-	CHECK_ERROR;
-	PUSH_BINARY_EXPR(XPATH_OP_AND, op1, ctxt->comp->last, 0, 0);
-	SKIP_BLANKS;
-    }
+void
+xmlXPathFloorFunction(xmlXPathParserContext *ctxt, int nargs) {
+    CHECK_ARITY(1);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+
+    ctxt->value->floatval = floor(ctxt->value->floatval);
 }
 
 /**
- *  [14]   Expr ::=   OrExpr
- *  [21]   OrExpr ::=   AndExpr
- *                 | OrExpr 'or' AndExpr
- *
- * Parse and compile an expression
+ * Implement the ceiling() XPath function
+ *    number ceiling(number)
+ * The ceiling function returns the smallest (closest to negative infinity)
+ * number that is not less than the argument and that is an integer.
  *
  * @param ctxt  the XPath Parser context
- * @param sort  whether to sort the resulting node set
+ * @param nargs  the number of arguments
  */
-static void
-xmlXPathCompileExpr(xmlXPathParserContextPtr ctxt, int sort) {
-    xmlXPathContextPtr xpctxt = ctxt->context;
+void
+xmlXPathCeilingFunction(xmlXPathParserContext *ctxt, int nargs) {
+    CHECK_ARITY(1);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
 
-    if (xpctxt != NULL) {
-        if (xpctxt->depth >= XPATH_MAX_RECURSION_DEPTH)
-            XP_ERROR(XPATH_RECURSION_LIMIT_EXCEEDED);
-        /*
-         * Parsing a single '(' pushes about 10 functions on the call stack
-         * before recursing!
-         */
-        xpctxt->depth += 10;
-    }
+#ifdef _AIX
+    /* Work around buggy ceil() function on AIX */
+    ctxt->value->floatval = copysign(ceil(ctxt->value->floatval), ctxt->value->floatval);
+#else
+    ctxt->value->floatval = ceil(ctxt->value->floatval);
+#endif
+}
 
-    xmlXPathCompAndExpr(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while ((CUR == 'o') && (NXT(1) == 'r')) {
-	int op1 = ctxt->comp->last;
-        SKIP(2);
-	SKIP_BLANKS;
-        xmlXPathCompAndExpr(ctxt);
-	CHECK_ERROR;
-	PUSH_BINARY_EXPR(XPATH_OP_OR, op1, ctxt->comp->last, 0, 0);
-	SKIP_BLANKS;
+/**
+ * Implement the round() XPath function
+ *    number round(number)
+ * The round function returns the number that is closest to the
+ * argument and that is an integer. If there are two such numbers,
+ * then the one that is closest to positive infinity is returned.
+ *
+ * @param ctxt  the XPath Parser context
+ * @param nargs  the number of arguments
+ */
+void
+xmlXPathRoundFunction(xmlXPathParserContext *ctxt, int nargs) {
+    double f;
+
+    CHECK_ARITY(1);
+    CAST_TO_NUMBER;
+    CHECK_TYPE(XPATH_NUMBER);
+
+    f = ctxt->value->floatval;
+
+    if ((f >= -0.5) && (f < 0.5)) {
+        /* Handles negative zero. */
+        ctxt->value->floatval *= 0.0;
     }
-    if ((sort) && (ctxt->comp->steps[ctxt->comp->last].op != XPATH_OP_VALUE)) {
-	/* more ops could be optimized too */
-	/*
-	* This is the main place to eliminate sorting for
-	* operations which don't require a sorted node-set.
-	* E.g. count().
-	*/
-	PUSH_UNARY_EXPR(XPATH_OP_SORT, ctxt->comp->last , 0, 0);
+    else {
+        double rounded = floor(f);
+        if (f - rounded >= 0.5)
+            rounded += 1.0;
+        ctxt->value->floatval = rounded;
     }
-
-    if (xpctxt != NULL)
-        xpctxt->depth -= 10;
 }
 
+/************************************************************************
+ *									*
+ *			The Parser					*
+ *									*
+ ************************************************************************/
+
+/*
+ * a few forward declarations since we use a recursive call based
+ * implementation.
+ */
+static void xmlXPathCompileExpr(xmlXPathParserContextPtr ctxt, int sort);
+static void xmlXPathCompPredicate(xmlXPathParserContextPtr ctxt, int filter);
+static void xmlXPathCompLocationPath(xmlXPathParserContextPtr ctxt);
+static void xmlXPathCompRelativeLocationPath(xmlXPathParserContextPtr ctxt);
+
 /**
- *  [8]   Predicate ::=   '[' PredicateExpr ']'
- *  [9]   PredicateExpr ::=   Expr
- *
- * Compile a predicate expression
+ * Parse an XML non-colonized name.
  *
  * @param ctxt  the XPath Parser context
- * @param filter  act as a filter
+ * @returns the nc name or NULL
  */
-static void
-xmlXPathCompPredicate(xmlXPathParserContextPtr ctxt, int filter) {
-    int op1 = ctxt->comp->last;
 
-    SKIP_BLANKS;
-    if (CUR != '[') {
-	XP_ERROR(XPATH_INVALID_PREDICATE_ERROR);
-    }
-    NEXT;
-    SKIP_BLANKS;
+xmlChar *
+xmlXPathParseNCName(xmlXPathParserContext *ctxt) {
+    const xmlChar *end;
+    xmlChar *ret;
 
-    ctxt->comp->last = -1;
-    /*
-    * This call to xmlXPathCompileExpr() will deactivate sorting
-    * of the predicate result.
-    * TODO: Sorting is still activated for filters, since I'm not
-    *  sure if needed. Normally sorting should not be needed, since
-    *  a filter can only diminish the number of items in a sequence,
-    *  but won't change its order; so if the initial sequence is sorted,
-    *  subsequent sorting is not needed.
-    */
-    if (! filter)
-	xmlXPathCompileExpr(ctxt, 0);
-    else
-	xmlXPathCompileExpr(ctxt, 1);
-    CHECK_ERROR;
+    if ((ctxt == NULL) || (ctxt->cur == NULL)) return(NULL);
 
-    if (CUR != ']') {
-	XP_ERROR(XPATH_INVALID_PREDICATE_ERROR);
+    end = xmlScanName(ctxt->cur, XML_MAX_NAME_LENGTH, XML_SCAN_NC);
+    if (end == NULL) {
+        XP_ERRORNULL(XPATH_EXPR_ERROR);
     }
+    if (end == ctxt->cur)
+        return(NULL);
 
-    if (filter)
-	PUSH_BINARY_EXPR(XPATH_OP_FILTER, op1, ctxt->comp->last, 0, 0);
-    else
-	PUSH_BINARY_EXPR(XPATH_OP_PREDICATE, op1, ctxt->comp->last, 0, 0);
-
-    NEXT;
-    SKIP_BLANKS;
+    ret = xmlStrndup(ctxt->cur, end - ctxt->cur);
+    if (ret == NULL)
+        xmlXPathPErrMemory(ctxt);
+    ctxt->cur = end;
+    return(ret);
 }
 
+
 /**
- * ```
- * [7] NodeTest ::=   NameTest
- *		    | NodeType '(' ')'
- *		    | 'processing-instruction' '(' Literal ')'
- *
- * [37] NameTest ::=  '*'
- *		    | NCName ':' '*'
- *		    | QName
- * [38] NodeType ::= 'comment'
- *		   | 'text'
- *		   | 'processing-instruction'
- *		   | 'node'
- * ```
+ * Parse an XML qualified name
  *
  * @param ctxt  the XPath Parser context
- * @param test  pointer to a xmlXPathTestVal
- * @param type  pointer to a xmlXPathTypeVal
- * @param prefix  placeholder for a possible name prefix
- * @param name  current name token (optional)
- * @returns the name found and updates `test`, `type` and `prefix` appropriately
+ * @param prefix  a xmlChar **
+ * @returns the function returns the local part, and prefix is updated
+ *   to get the Prefix if any.
  */
+
 static xmlChar *
-xmlXPathCompNodeTest(xmlXPathParserContextPtr ctxt, xmlXPathTestVal *test,
-	             xmlXPathTypeVal *type, xmlChar **prefix,
-		     xmlChar *name) {
-    int blanks;
+xmlXPathParseQName(xmlXPathParserContextPtr ctxt, xmlChar **prefix) {
+    xmlChar *ret = NULL;
 
-    if ((test == NULL) || (type == NULL) || (prefix == NULL)) {
-	return(NULL);
-    }
-    *type = (xmlXPathTypeVal) 0;
-    *test = (xmlXPathTestVal) 0;
     *prefix = NULL;
-    SKIP_BLANKS;
-
-    if ((name == NULL) && (CUR == '*')) {
-	/*
-	 * All elements
-	 */
+    ret = xmlXPathParseNCName(ctxt);
+    if (ret && CUR == ':') {
+        *prefix = ret;
 	NEXT;
-	*test = NODE_TEST_ALL;
-	return(NULL);
+	ret = xmlXPathParseNCName(ctxt);
     }
+    return(ret);
+}
 
-    if (name == NULL)
-	name = xmlXPathParseNCName(ctxt);
-    if (name == NULL) {
-	XP_ERRORNULL(XPATH_EXPR_ERROR);
-    }
+/**
+ * parse an XML name
+ *
+ * @param ctxt  the XPath Parser context
+ * @returns the name or NULL
+ */
 
-    blanks = IS_BLANK_CH(CUR);
-    SKIP_BLANKS;
-    if (CUR == '(') {
-	NEXT;
-	/*
-	 * NodeType or PI search
-	 */
-	if (xmlStrEqual(name, BAD_CAST "comment"))
-	    *type = NODE_TYPE_COMMENT;
-	else if (xmlStrEqual(name, BAD_CAST "node"))
-	    *type = NODE_TYPE_NODE;
-	else if (xmlStrEqual(name, BAD_CAST "processing-instruction"))
-	    *type = NODE_TYPE_PI;
-	else if (xmlStrEqual(name, BAD_CAST "text"))
-	    *type = NODE_TYPE_TEXT;
-	else {
-	    if (name != NULL)
-		xmlFree(name);
-	    XP_ERRORNULL(XPATH_EXPR_ERROR);
-	}
+xmlChar *
+xmlXPathParseName(xmlXPathParserContext *ctxt) {
+    const xmlChar *end;
+    xmlChar *ret;
 
-	*test = NODE_TEST_TYPE;
+    if ((ctxt == NULL) || (ctxt->cur == NULL)) return(NULL);
 
-	SKIP_BLANKS;
-	if (*type == NODE_TYPE_PI) {
-	    /*
-	     * Specific case: search a PI by name.
-	     */
-	    if (name != NULL)
-		xmlFree(name);
-	    name = NULL;
-	    if (CUR != ')') {
-		name = xmlXPathParseLiteral(ctxt);
-		*test = NODE_TEST_PI;
-		SKIP_BLANKS;
-	    }
-	}
-	if (CUR != ')') {
-	    if (name != NULL)
-		xmlFree(name);
-	    XP_ERRORNULL(XPATH_UNCLOSED_ERROR);
-	}
-	NEXT;
-	return(name);
+    end = xmlScanName(ctxt->cur, XML_MAX_NAME_LENGTH, 0);
+    if (end == NULL) {
+        XP_ERRORNULL(XPATH_EXPR_ERROR);
     }
-    *test = NODE_TEST_NAME;
-    if ((!blanks) && (CUR == ':')) {
-	NEXT;
-
-	/*
-	 * Since currently the parser context don't have a
-	 * namespace list associated:
-	 * The namespace name for this prefix can be computed
-	 * only at evaluation time. The compilation is done
-	 * outside of any context.
-	 */
-	*prefix = name;
-
-	if (CUR == '*') {
-	    /*
-	     * All elements
-	     */
-	    NEXT;
-	    *test = NODE_TEST_ALL;
-	    return(NULL);
-	}
+    if (end == ctxt->cur)
+        return(NULL);
 
-	name = xmlXPathParseNCName(ctxt);
-	if (name == NULL) {
-	    XP_ERRORNULL(XPATH_EXPR_ERROR);
-	}
-    }
-    return(name);
+    ret = xmlStrndup(ctxt->cur, end - ctxt->cur);
+    if (ret == NULL)
+        xmlXPathPErrMemory(ctxt);
+    ctxt->cur = end;
+    return(ret);
 }
 
 /**
- * [6] AxisName ::=   'ancestor'
- *                  | 'ancestor-or-self'
- *                  | 'attribute'
- *                  | 'child'
- *                  | 'descendant'
- *                  | 'descendant-or-self'
- *                  | 'following'
- *                  | 'following-sibling'
- *                  | 'namespace'
- *                  | 'parent'
- *                  | 'preceding'
- *                  | 'preceding-sibling'
- *                  | 'self'
+ *  [30a]  Float  ::= Number ('e' Digits?)?
  *
- * @param name  a preparsed name token
- * @returns the axis or 0
+ *  [30]   Number ::=   Digits ('.' Digits?)?
+ *                    | '.' Digits
+ *  [31]   Digits ::=   [0-9]+
+ *
+ * Compile a Number in the string
+ * In complement of the Number expression, this function also handles
+ * negative values : '-' Number.
+ *
+ * @param str  A string to scan
+ * @returns the double value.
  */
-static xmlXPathAxisVal
-xmlXPathIsAxisName(const xmlChar *name) {
-    xmlXPathAxisVal ret = (xmlXPathAxisVal) 0;
-    switch (name[0]) {
-	case 'a':
-	    if (xmlStrEqual(name, BAD_CAST "ancestor"))
-		ret = AXIS_ANCESTOR;
-	    if (xmlStrEqual(name, BAD_CAST "ancestor-or-self"))
-		ret = AXIS_ANCESTOR_OR_SELF;
-	    if (xmlStrEqual(name, BAD_CAST "attribute"))
-		ret = AXIS_ATTRIBUTE;
-	    break;
-	case 'c':
-	    if (xmlStrEqual(name, BAD_CAST "child"))
-		ret = AXIS_CHILD;
-	    break;
-	case 'd':
-	    if (xmlStrEqual(name, BAD_CAST "descendant"))
-		ret = AXIS_DESCENDANT;
-	    if (xmlStrEqual(name, BAD_CAST "descendant-or-self"))
-		ret = AXIS_DESCENDANT_OR_SELF;
-	    break;
-	case 'f':
-	    if (xmlStrEqual(name, BAD_CAST "following"))
-		ret = AXIS_FOLLOWING;
-	    if (xmlStrEqual(name, BAD_CAST "following-sibling"))
-		ret = AXIS_FOLLOWING_SIBLING;
-	    break;
-	case 'n':
-	    if (xmlStrEqual(name, BAD_CAST "namespace"))
-		ret = AXIS_NAMESPACE;
-	    break;
-	case 'p':
-	    if (xmlStrEqual(name, BAD_CAST "parent"))
-		ret = AXIS_PARENT;
-	    if (xmlStrEqual(name, BAD_CAST "preceding"))
-		ret = AXIS_PRECEDING;
-	    if (xmlStrEqual(name, BAD_CAST "preceding-sibling"))
-		ret = AXIS_PRECEDING_SIBLING;
-	    break;
-	case 's':
-	    if (xmlStrEqual(name, BAD_CAST "self"))
-		ret = AXIS_SELF;
-	    break;
+double
+xmlXPathStringEvalNumber(const xmlChar *str) {
+    const xmlChar *cur = str;
+    double ret;
+    int isneg = 0;
+
+    if (cur == NULL) return(0);
+    while (IS_BLANK_CH(*cur)) cur++;
+    if (*cur == '-') {
+	isneg = 1;
+	cur++;
     }
+    ret = xmlXPathParseNumber(cur, &cur);
+    if (xmlXPathIsNaN(ret))
+        return(xmlXPathNAN);
+    while (IS_BLANK_CH(*cur)) cur++;
+    if (*cur != 0) return(xmlXPathNAN);
+    if (isneg) ret = -ret;
     return(ret);
 }
 
 /**
- * [4] Step ::=   AxisSpecifier NodeTest Predicate*
- *                  | AbbreviatedStep
- *
- * [12] AbbreviatedStep ::=   '.' | '..'
- *
- * [5] AxisSpecifier ::= AxisName '::'
- *                  | AbbreviatedAxisSpecifier
- *
- * [13] AbbreviatedAxisSpecifier ::= '@'?
- *
- * Modified for XPtr range support as:
- *
- *  [4xptr] Step ::= AxisSpecifier NodeTest Predicate*
- *                     | AbbreviatedStep
- *                     | 'range-to' '(' Expr ')' Predicate*
+ *  [30]   Number ::=   Digits ('.' Digits?)?
+ *                    | '.' Digits
+ *  [31]   Digits ::=   [0-9]+
  *
- * Compile one step in a Location Path
+ * Compile a Number, then push it on the stack
  *
  * @param ctxt  the XPath Parser context
  */
 static void
-xmlXPathCompStep(xmlXPathParserContextPtr ctxt) {
-    SKIP_BLANKS;
-    if ((CUR == '.') && (NXT(1) == '.')) {
-	SKIP(2);
-	SKIP_BLANKS;
-	PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_PARENT,
-		    NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
-    } else if (CUR == '.') {
-	NEXT;
-	SKIP_BLANKS;
-    } else {
-	xmlChar *name = NULL;
-	xmlChar *prefix = NULL;
-	xmlXPathTestVal test = (xmlXPathTestVal) 0;
-	xmlXPathAxisVal axis = (xmlXPathAxisVal) 0;
-	xmlXPathTypeVal type = (xmlXPathTypeVal) 0;
-	int op1;
-
-	if (CUR == '*') {
-	    axis = AXIS_CHILD;
-	} else {
-	    if (name == NULL)
-		name = xmlXPathParseNCName(ctxt);
-	    if (name != NULL) {
-		axis = xmlXPathIsAxisName(name);
-		if (axis != 0) {
-		    SKIP_BLANKS;
-		    if ((CUR == ':') && (NXT(1) == ':')) {
-			SKIP(2);
-			xmlFree(name);
-			name = NULL;
-		    } else {
-			/* an element name can conflict with an axis one :-\ */
-			axis = AXIS_CHILD;
-		    }
-		} else {
-		    axis = AXIS_CHILD;
-		}
-	    } else if (CUR == '@') {
-		NEXT;
-		axis = AXIS_ATTRIBUTE;
-	    } else {
-		axis = AXIS_CHILD;
-	    }
-	}
-
-        if (ctxt->error != XPATH_EXPRESSION_OK) {
-            xmlFree(name);
-            return;
-        }
-
-	name = xmlXPathCompNodeTest(ctxt, &test, &type, &prefix, name);
-	if (test == 0)
-	    return;
-
-        if ((prefix != NULL) && (ctxt->context != NULL) &&
-	    (ctxt->context->flags & XML_XPATH_CHECKNS)) {
-	    if (xmlXPathNsLookup(ctxt->context, prefix) == NULL) {
-		xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
-                               "Undefined namespace prefix: %s\n", prefix);
-	    }
-	}
-
-	op1 = ctxt->comp->last;
-	ctxt->comp->last = -1;
-
-	SKIP_BLANKS;
-	while (CUR == '[') {
-	    xmlXPathCompPredicate(ctxt, 0);
-	}
+xmlXPathCompNumber(xmlXPathParserContextPtr ctxt)
+{
+    const xmlChar *end;
+    double ret;
+    xmlXPathObjectPtr num;
 
-        if (PUSH_FULL_EXPR(XPATH_OP_COLLECT, op1, ctxt->comp->last, axis,
-                           test, type, (void *)prefix, (void *)name) == -1) {
-            xmlFree(prefix);
-            xmlFree(name);
-        }
+    CHECK_ERROR;
+    ret = xmlXPathParseNumber(CUR_PTR, &end);
+    if (xmlXPathIsNaN(ret)) {
+        XP_ERROR(XPATH_NUMBER_ERROR);
+    }
+    CUR_PTR = end;
+    num = xmlXPathCacheNewFloat(ctxt, ret);
+    if (num == NULL) {
+	ctxt->error = XPATH_MEMORY_ERROR;
+    } else if (PUSH_LONG_EXPR(XPATH_OP_VALUE, XPATH_NUMBER, 0, 0, num,
+                              NULL) == -1) {
+        xmlXPathReleaseObject(ctxt->context, num);
     }
 }
 
 /**
- *  [3]   RelativeLocationPath ::=   Step
- *                     | RelativeLocationPath '/' Step
- *                     | AbbreviatedRelativeLocationPath
- *  [11]  AbbreviatedRelativeLocationPath ::=   RelativeLocationPath '//' Step
+ * Parse a Literal
  *
- * Compile a relative location path.
+ *  [29]   Literal ::=   '"' [^"]* '"'
+ *                    | "'" [^']* "'"
  *
  * @param ctxt  the XPath Parser context
+ * @returns the value found or NULL in case of error
  */
-static void
-xmlXPathCompRelativeLocationPath
-(xmlXPathParserContextPtr ctxt) {
-    SKIP_BLANKS;
-    if ((CUR == '/') && (NXT(1) == '/')) {
-	SKIP(2);
-	SKIP_BLANKS;
-	PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
-		         NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
-    } else if (CUR == '/') {
-	    NEXT;
-	SKIP_BLANKS;
-    }
-    xmlXPathCompStep(ctxt);
-    CHECK_ERROR;
-    SKIP_BLANKS;
-    while (CUR == '/') {
-	if ((CUR == '/') && (NXT(1) == '/')) {
-	    SKIP(2);
-	    SKIP_BLANKS;
-	    PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
-			     NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
-	    xmlXPathCompStep(ctxt);
-	} else if (CUR == '/') {
-	    NEXT;
-	    SKIP_BLANKS;
-	    xmlXPathCompStep(ctxt);
-	}
-	SKIP_BLANKS;
+static xmlChar *
+xmlXPathParseLiteral(xmlXPathParserContextPtr ctxt) {
+    const xmlChar *q;
+    xmlChar *ret = NULL;
+    int quote;
+
+    if (CUR == '"') {
+        quote = '"';
+    } else if (CUR == '\'') {
+        quote = '\'';
+    } else {
+	XP_ERRORNULL(XPATH_START_LITERAL_ERROR);
+    }
+
+    NEXT;
+    q = CUR_PTR;
+    while (CUR != quote) {
+        int ch;
+        int len = 4;
+
+        if (CUR == 0)
+            XP_ERRORNULL(XPATH_UNFINISHED_LITERAL_ERROR);
+        ch = xmlGetUTF8Char(CUR_PTR, &len);
+        if ((ch < 0) || (IS_CHAR(ch) == 0))
+            XP_ERRORNULL(XPATH_INVALID_CHAR_ERROR);
+        CUR_PTR += len;
     }
+    ret = xmlStrndup(q, CUR_PTR - q);
+    if (ret == NULL)
+        xmlXPathPErrMemory(ctxt);
+    NEXT;
+    return(ret);
 }
 
 /**
- *  [1]   LocationPath ::=   RelativeLocationPath
- *                     | AbsoluteLocationPath
- *  [2]   AbsoluteLocationPath ::=   '/' RelativeLocationPath?
- *                     | AbbreviatedAbsoluteLocationPath
- *  [10]   AbbreviatedAbsoluteLocationPath ::=
- *                           '//' RelativeLocationPath
+ * Parse a Literal and push it on the stack.
  *
- * Compile a location path
+ *  [29]   Literal ::=   '"' [^"]* '"'
+ *                    | "'" [^']* "'"
+ *
+ * TODO: Memory allocation could be improved.
  *
  * @param ctxt  the XPath Parser context
  */
 static void
-xmlXPathCompLocationPath(xmlXPathParserContextPtr ctxt) {
+xmlXPathCompLiteral(xmlXPathParserContextPtr ctxt) {
+    xmlChar *ret = NULL;
+    xmlXPathObjectPtr lit;
+
+    ret = xmlXPathParseLiteral(ctxt);
+    if (ret == NULL)
+        return;
+    lit = xmlXPathCacheNewString(ctxt, ret);
+    if (lit == NULL) {
+        ctxt->error = XPATH_MEMORY_ERROR;
+    } else if (PUSH_LONG_EXPR(XPATH_OP_VALUE, XPATH_STRING, 0, 0, lit,
+                              NULL) == -1) {
+        xmlXPathReleaseObject(ctxt->context, lit);
+    }
+    xmlFree(ret);
+}
+
+/**
+ * Parse a VariableReference, evaluate it and push it on the stack.
+ *
+ * The variable bindings consist of a mapping from variable names
+ * to variable values. The value of a variable is an object, which can be
+ * of any of the types that are possible for the value of an expression,
+ * and may also be of additional types not specified here.
+ *
+ * Early evaluation is possible since:
+ * The variable bindings [...] used to evaluate a subexpression are
+ * always the same as those used to evaluate the containing expression.
+ *
+ *  [36]   VariableReference ::=   '$' QName
+ * @param ctxt  the XPath Parser context
+ */
+static void
+xmlXPathCompVariableReference(xmlXPathParserContextPtr ctxt) {
+    xmlChar *name;
+    xmlChar *prefix;
+
     SKIP_BLANKS;
-    if (CUR != '/') {
-        xmlXPathCompRelativeLocationPath(ctxt);
-    } else {
-	while (CUR == '/') {
-	    if ((CUR == '/') && (NXT(1) == '/')) {
-		SKIP(2);
-		SKIP_BLANKS;
-		PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
-			     NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
-		xmlXPathCompRelativeLocationPath(ctxt);
-	    } else if (CUR == '/') {
-		NEXT;
-		SKIP_BLANKS;
-		if ((CUR != 0) &&
-		    ((IS_ASCII_LETTER(CUR)) || (CUR >= 0x80) ||
-                     (CUR == '_') || (CUR == '.') ||
-		     (CUR == '@') || (CUR == '*')))
-		    xmlXPathCompRelativeLocationPath(ctxt);
-	    }
-	    CHECK_ERROR;
-	}
+    if (CUR != '$') {
+	XP_ERROR(XPATH_VARIABLE_REF_ERROR);
+    }
+    NEXT;
+    name = xmlXPathParseQName(ctxt, &prefix);
+    if (name == NULL) {
+        xmlFree(prefix);
+	XP_ERROR(XPATH_VARIABLE_REF_ERROR);
+    }
+    ctxt->comp->last = -1;
+    if (PUSH_LONG_EXPR(XPATH_OP_VARIABLE, 0, 0, 0, name, prefix) == -1) {
+        xmlFree(prefix);
+        xmlFree(name);
+    }
+    SKIP_BLANKS;
+    if ((ctxt->context != NULL) && (ctxt->context->flags & XML_XPATH_NOVAR)) {
+	XP_ERROR(XPATH_FORBID_VARIABLE_ERROR);
     }
 }
 
-/************************************************************************
- *									*
- *		XPath precompiled expression evaluation			*
- *									*
- ************************************************************************/
+/**
+ * Is the name given a NodeType one.
+ *
+ *  [38]   NodeType ::=   'comment'
+ *                    | 'text'
+ *                    | 'processing-instruction'
+ *                    | 'node'
+ *
+ * @param name  a name string
+ * @returns 1 if true 0 otherwise
+ */
+int
+xmlXPathIsNodeType(const xmlChar *name) {
+    if (name == NULL)
+	return(0);
 
-static int
-xmlXPathCompOpEval(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op);
+    if (xmlStrEqual(name, BAD_CAST "node"))
+	return(1);
+    if (xmlStrEqual(name, BAD_CAST "text"))
+	return(1);
+    if (xmlStrEqual(name, BAD_CAST "comment"))
+	return(1);
+    if (xmlStrEqual(name, BAD_CAST "processing-instruction"))
+	return(1);
+    return(0);
+}
 
 /**
- * Filter a node set, keeping only nodes for which the predicate expression
- * matches. Afterwards, keep only nodes between minPos and maxPos in the
- * filtered result.
+ *  [16]   FunctionCall ::=   FunctionName '(' ( Argument ( ',' Argument)*)? ')'
+ *  [17]   Argument ::=   Expr
+ *
+ * Compile a function call, the evaluation of all arguments are
+ * pushed on the stack
  *
  * @param ctxt  the XPath Parser context
- * @param set  the node set to filter
- * @param filterOpIndex  the index of the predicate/filter op
- * @param minPos  minimum position in the filtered set (1-based)
- * @param maxPos  maximum position in the filtered set (1-based)
- * @param hasNsNodes  true if the node set may contain namespace nodes
  */
 static void
-xmlXPathNodeSetFilter(xmlXPathParserContextPtr ctxt,
-		      xmlNodeSetPtr set,
-		      int filterOpIndex,
-                      int minPos, int maxPos,
-		      int hasNsNodes)
-{
-    xmlXPathContextPtr xpctxt;
-    xmlNodePtr oldnode;
-    xmlDocPtr olddoc;
-    xmlXPathStepOpPtr filterOp;
-    int oldcs, oldpp;
-    int i, j, pos;
+xmlXPathCompFunctionCall(xmlXPathParserContextPtr ctxt) {
+    xmlChar *name;
+    xmlChar *prefix;
+    int nbargs = 0;
+    int sort = 1;
 
-    if ((set == NULL) || (set->nodeNr == 0))
-        return;
+    name = xmlXPathParseQName(ctxt, &prefix);
+    if (name == NULL) {
+	xmlFree(prefix);
+	XP_ERROR(XPATH_EXPR_ERROR);
+    }
+    SKIP_BLANKS;
+
+    if (CUR != '(') {
+	xmlFree(name);
+	xmlFree(prefix);
+	XP_ERROR(XPATH_EXPR_ERROR);
+    }
+    NEXT;
+    SKIP_BLANKS;
 
     /*
-    * Check if the node set contains a sufficient number of nodes for
-    * the requested range.
+    * Optimization for count(): we don't need the node-set to be sorted.
     */
-    if (set->nodeNr < minPos) {
-        xmlXPathNodeSetClear(set, hasNsNodes);
-        return;
+    if ((prefix == NULL) && (name[0] == 'c') &&
+	xmlStrEqual(name, BAD_CAST "count"))
+    {
+	sort = 0;
     }
+    ctxt->comp->last = -1;
+    if (CUR != ')') {
+	while (CUR != 0) {
+	    int op1 = ctxt->comp->last;
+	    ctxt->comp->last = -1;
+	    xmlXPathCompileExpr(ctxt, sort);
+	    if (ctxt->error != XPATH_EXPRESSION_OK) {
+		xmlFree(name);
+		xmlFree(prefix);
+		return;
+	    }
+	    PUSH_BINARY_EXPR(XPATH_OP_ARG, op1, ctxt->comp->last, 0, 0);
+	    nbargs++;
+	    if (CUR == ')') break;
+	    if (CUR != ',') {
+		xmlFree(name);
+		xmlFree(prefix);
+		XP_ERROR(XPATH_EXPR_ERROR);
+	    }
+	    NEXT;
+	    SKIP_BLANKS;
+	}
+    }
+    if (PUSH_LONG_EXPR(XPATH_OP_FUNCTION, nbargs, 0, 0, name, prefix) == -1) {
+        xmlFree(prefix);
+        xmlFree(name);
+    } else if (prefix == NULL) {
+        xmlXPathStepOpPtr op = &ctxt->comp->steps[ctxt->comp->last];
 
-    xpctxt = ctxt->context;
-    oldnode = xpctxt->node;
-    olddoc = xpctxt->doc;
-    oldcs = xpctxt->contextSize;
-    oldpp = xpctxt->proximityPosition;
-    filterOp = &ctxt->comp->steps[filterOpIndex];
-
-    xpctxt->contextSize = set->nodeNr;
-
-    for (i = 0, j = 0, pos = 1; i < set->nodeNr; i++) {
-        xmlNodePtr node = set->nodeTab[i];
-        int res;
-
-        xpctxt->node = node;
-        xpctxt->proximityPosition = i + 1;
-
-        /*
-        * Also set the xpath document in case things like
-        * key() are evaluated in the predicate.
-        *
-        * TODO: Get real doc for namespace nodes.
-        */
-        if ((node->type != XML_NAMESPACE_DECL) &&
-            (node->doc != NULL))
-            xpctxt->doc = node->doc;
-
-        res = xmlXPathCompOpEvalToBoolean(ctxt, filterOp, 1);
-
-        if (ctxt->error != XPATH_EXPRESSION_OK)
-            break;
-        if (res < 0) {
-            /* Shouldn't happen */
-            xmlXPathErr(ctxt, XPATH_EXPR_ERROR);
-            break;
-        }
-
-        if ((res != 0) && ((pos >= minPos) && (pos <= maxPos))) {
-            if (i != j) {
-                set->nodeTab[j] = node;
-                set->nodeTab[i] = NULL;
-            }
-
-            j += 1;
-        } else {
-            /* Remove the entry from the initial node set. */
-            set->nodeTab[i] = NULL;
-            if (node->type == XML_NAMESPACE_DECL)
-                xmlXPathNodeSetFreeNs((xmlNsPtr) node);
-        }
-
-        if (res != 0) {
-            if (pos == maxPos) {
-                i += 1;
-                break;
-            }
-
-            pos += 1;
-        }
-    }
-
-    /* Free remaining nodes. */
-    if (hasNsNodes) {
-        for (; i < set->nodeNr; i++) {
-            xmlNodePtr node = set->nodeTab[i];
-            if ((node != NULL) && (node->type == XML_NAMESPACE_DECL))
-                xmlXPathNodeSetFreeNs((xmlNsPtr) node);
-        }
-    }
-
-    set->nodeNr = j;
-
-    /* If too many elements were removed, shrink table to preserve memory. */
-    if ((set->nodeMax > XML_NODESET_DEFAULT) &&
-        (set->nodeNr < set->nodeMax / 2)) {
-        xmlNodePtr *tmp;
-        int nodeMax = set->nodeNr;
-
-        if (nodeMax < XML_NODESET_DEFAULT)
-            nodeMax = XML_NODESET_DEFAULT;
-        tmp = (xmlNodePtr *) xmlRealloc(set->nodeTab,
-                nodeMax * sizeof(xmlNodePtr));
-        if (tmp == NULL) {
-            xmlXPathPErrMemory(ctxt);
-        } else {
-            set->nodeTab = tmp;
-            set->nodeMax = nodeMax;
-        }
-    }
-
-    xpctxt->node = oldnode;
-    xpctxt->doc = olddoc;
-    xpctxt->contextSize = oldcs;
-    xpctxt->proximityPosition = oldpp;
-}
+        op->cache = xmlXPathStandardFunctionLookup(op->value4);
+    }
+    NEXT;
+    SKIP_BLANKS;
+}
 
 /**
- * Filter a node set, keeping only nodes for which the sequence of predicate
- * expressions matches. Afterwards, keep only nodes between minPos and maxPos
- * in the filtered result.
+ *  [15]   PrimaryExpr ::=   VariableReference
+ *                | '(' Expr ')'
+ *                | Literal
+ *                | Number
+ *                | FunctionCall
+ *
+ * Compile a primary expression.
  *
  * @param ctxt  the XPath Parser context
- * @param op  the predicate op
- * @param set  the node set to filter
- * @param minPos  minimum position in the filtered set (1-based)
- * @param maxPos  maximum position in the filtered set (1-based)
- * @param hasNsNodes  true if the node set may contain namespace nodes
  */
 static void
-xmlXPathCompOpEvalPredicate(xmlXPathParserContextPtr ctxt,
-			    xmlXPathStepOpPtr op,
-			    xmlNodeSetPtr set,
-                            int minPos, int maxPos,
-			    int hasNsNodes)
-{
-    if (op->ch1 != -1) {
-	xmlXPathCompExprPtr comp = ctxt->comp;
-	/*
-	* Process inner predicates first.
-	*/
-	if (comp->steps[op->ch1].op != XPATH_OP_PREDICATE) {
-            XP_ERROR(XPATH_INVALID_OPERAND);
-	}
-        if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
-            XP_ERROR(XPATH_RECURSION_LIMIT_EXCEEDED);
-        ctxt->context->depth += 1;
-	xmlXPathCompOpEvalPredicate(ctxt, &comp->steps[op->ch1], set,
-                                    1, set->nodeNr, hasNsNodes);
-        ctxt->context->depth -= 1;
+xmlXPathCompPrimaryExpr(xmlXPathParserContextPtr ctxt) {
+    SKIP_BLANKS;
+    if (CUR == '$') xmlXPathCompVariableReference(ctxt);
+    else if (CUR == '(') {
+	NEXT;
+	SKIP_BLANKS;
+	xmlXPathCompileExpr(ctxt, 1);
 	CHECK_ERROR;
+	if (CUR != ')') {
+	    XP_ERROR(XPATH_EXPR_ERROR);
+	}
+	NEXT;
+	SKIP_BLANKS;
+    } else if (IS_ASCII_DIGIT(CUR) || (CUR == '.' && IS_ASCII_DIGIT(NXT(1)))) {
+	xmlXPathCompNumber(ctxt);
+    } else if ((CUR == '\'') || (CUR == '"')) {
+	xmlXPathCompLiteral(ctxt);
+    } else {
+	xmlXPathCompFunctionCall(ctxt);
     }
-
-    if (op->ch2 != -1)
-        xmlXPathNodeSetFilter(ctxt, set, op->ch2, minPos, maxPos, hasNsNodes);
+    SKIP_BLANKS;
 }
 
-static int
-xmlXPathIsPositionalPredicate(xmlXPathParserContextPtr ctxt,
-			    xmlXPathStepOpPtr op,
-			    int *maxPos)
-{
+/**
+ *  [20]   FilterExpr ::=   PrimaryExpr
+ *               | FilterExpr Predicate
+ *
+ * Compile a filter expression.
+ * Square brackets are used to filter expressions in the same way that
+ * they are used in location paths. It is an error if the expression to
+ * be filtered does not evaluate to a node-set. The context node list
+ * used for evaluating the expression in square brackets is the node-set
+ * to be filtered listed in document order.
+ *
+ * @param ctxt  the XPath Parser context
+ */
 
-    xmlXPathStepOpPtr exprOp;
+static void
+xmlXPathCompFilterExpr(xmlXPathParserContextPtr ctxt) {
+    xmlXPathCompPrimaryExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
 
-    /*
-    * BIG NOTE: This is not intended for XPATH_OP_FILTER yet!
-    */
+    while (CUR == '[') {
+	xmlXPathCompPredicate(ctxt, 1);
+	SKIP_BLANKS;
+    }
 
-    /*
-    * If not -1, then ch1 will point to:
-    * 1) For predicates (XPATH_OP_PREDICATE):
-    *    - an inner predicate operator
-    * 2) For filters (XPATH_OP_FILTER):
-    *    - an inner filter operator OR
-    *    - an expression selecting the node set.
-    *      E.g. "key('a', 'b')" or "(//foo | //bar)".
-    */
-    if ((op->op != XPATH_OP_PREDICATE) && (op->op != XPATH_OP_FILTER))
-	return(0);
 
-    if (op->ch2 != -1) {
-	exprOp = &ctxt->comp->steps[op->ch2];
-    } else
-	return(0);
+}
 
-    if ((exprOp != NULL) &&
-	(exprOp->op == XPATH_OP_VALUE) &&
-	(exprOp->value4 != NULL) &&
-	(((xmlXPathObjectPtr) exprOp->value4)->type == XPATH_NUMBER))
-    {
-        double floatval = ((xmlXPathObjectPtr) exprOp->value4)->floatval;
+/**
+ * Trickery: parse an XML name but without consuming the input flow
+ * Needed to avoid insanity in the parser state.
+ *
+ * @param ctxt  the XPath Parser context
+ * @returns the Name parsed or NULL
+ */
 
-	/*
-	* We have a "[n]" predicate here.
-	* TODO: Unfortunately this simplistic test here is not
-	* able to detect a position() predicate in compound
-	* expressions like "[@attr = 'a" and position() = 1],
-	* and even not the usage of position() in
-	* "[position() = 1]"; thus - obviously - a position-range,
-	* like it "[position() < 5]", is also not detected.
-	* Maybe we could rewrite the AST to ease the optimization.
-	*/
+static xmlChar *
+xmlXPathScanName(xmlXPathParserContextPtr ctxt) {
+    const xmlChar *end;
+    xmlChar *ret;
 
-        if ((floatval > INT_MIN) && (floatval < INT_MAX)) {
-	    *maxPos = (int) floatval;
-            if (floatval == (double) *maxPos)
-                return(1);
-        }
+    end = xmlScanName(ctxt->cur, XML_MAX_NAME_LENGTH, 0);
+    if (end == NULL) {
+        XP_ERRORNULL(XPATH_EXPR_ERROR);
     }
-    return(0);
-}
+    if (end == ctxt->cur)
+        return(NULL);
 
-static int
-xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
-                           xmlXPathStepOpPtr op,
-			   xmlNodePtr * first, xmlNodePtr * last,
-			   int toBool)
-{
+    ret = xmlStrndup(ctxt->cur, end - ctxt->cur);
+    if (ret == NULL)
+        xmlXPathPErrMemory(ctxt);
+    return(ret);
+}
 
-#define XP_TEST_HIT \
-    if (hasAxisRange != 0) { \
-	if (++pos == maxPos) { \
-	    if (addNode(seq, cur) < 0) \
-	        xmlXPathPErrMemory(ctxt); \
-	    goto axis_range_end; } \
-    } else { \
-	if (addNode(seq, cur) < 0) \
-	    xmlXPathPErrMemory(ctxt); \
-	if (breakOnFirstHit) goto first_hit; }
+/**
+ *  [19]   PathExpr ::=   LocationPath
+ *               | FilterExpr
+ *               | FilterExpr '/' RelativeLocationPath
+ *               | FilterExpr '//' RelativeLocationPath
+ *
+ * Compile a path expression.
+ *
+ * @param ctxt  the XPath Parser context
+ */
 
-#define XP_TEST_HIT_NS \
-    if (hasAxisRange != 0) { \
-	if (++pos == maxPos) { \
-	    hasNsNodes = 1; \
-	    if (xmlXPathNodeSetAddNs(seq, xpctxt->node, (xmlNsPtr) cur) < 0) \
-	        xmlXPathPErrMemory(ctxt); \
-	goto axis_range_end; } \
-    } else { \
-	hasNsNodes = 1; \
-	if (xmlXPathNodeSetAddNs(seq, xpctxt->node, (xmlNsPtr) cur) < 0) \
-	    xmlXPathPErrMemory(ctxt); \
-	if (breakOnFirstHit) goto first_hit; }
+static void
+xmlXPathCompPathExpr(xmlXPathParserContextPtr ctxt) {
+    int lc = 1;           /* Should we branch to LocationPath ?         */
+    xmlChar *name = NULL; /* we may have to preparse a name to find out */
 
-    xmlXPathAxisVal axis = (xmlXPathAxisVal) op->value;
-    xmlXPathTestVal test = (xmlXPathTestVal) op->value2;
-    xmlXPathTypeVal type = (xmlXPathTypeVal) op->value3;
-    const xmlChar *prefix = op->value4;
-    const xmlChar *name = op->value5;
-    const xmlChar *URI = NULL;
+    SKIP_BLANKS;
+    if ((CUR == '$') || (CUR == '(') ||
+	(IS_ASCII_DIGIT(CUR)) ||
+        (CUR == '\'') || (CUR == '"') ||
+	(CUR == '.' && IS_ASCII_DIGIT(NXT(1)))) {
+	lc = 0;
+    } else if (CUR == '*') {
+	/* relative or absolute location path */
+	lc = 1;
+    } else if (CUR == '/') {
+	/* relative or absolute location path */
+	lc = 1;
+    } else if (CUR == '@') {
+	/* relative abbreviated attribute location path */
+	lc = 1;
+    } else if (CUR == '.') {
+	/* relative abbreviated attribute location path */
+	lc = 1;
+    } else {
+	/*
+	 * Problem is finding if we have a name here whether it's:
+	 *   - a nodetype
+	 *   - a function call in which case it's followed by '('
+	 *   - an axis in which case it's followed by ':'
+	 *   - a element name
+	 * We do an a priori analysis here rather than having to
+	 * maintain parsed token content through the recursive function
+	 * calls. This looks uglier but makes the code easier to
+	 * read/write/debug.
+	 */
+	SKIP_BLANKS;
+	name = xmlXPathScanName(ctxt);
+	if ((name != NULL) && (xmlStrstr(name, (xmlChar *) "::") != NULL)) {
+	    lc = 1;
+	    xmlFree(name);
+	} else if (name != NULL) {
+	    int len =xmlStrlen(name);
 
-    int total = 0, hasNsNodes = 0;
-    /* The popped object holding the context nodes */
-    xmlXPathObjectPtr obj;
-    /* The set of context nodes for the node tests */
-    xmlNodeSetPtr contextSeq;
-    int contextIdx;
-    xmlNodePtr contextNode;
-    /* The final resulting node set wrt to all context nodes */
-    xmlNodeSetPtr outSeq;
-    /*
-    * The temporary resulting node set wrt 1 context node.
-    * Used to feed predicate evaluation.
-    */
-    xmlNodeSetPtr seq;
-    xmlNodePtr cur;
-    /* First predicate operator */
-    xmlXPathStepOpPtr predOp;
-    int maxPos; /* The requested position() (when a "[n]" predicate) */
-    int hasPredicateRange, hasAxisRange, pos;
-    int breakOnFirstHit;
 
-    xmlXPathTraversalFunction next = NULL;
-    int (*addNode) (xmlNodeSetPtr, xmlNodePtr);
-    xmlXPathNodeSetMergeFunction mergeAndClear;
-    xmlNodePtr oldContextNode;
-    xmlXPathContextPtr xpctxt = ctxt->context;
+	    while (NXT(len) != 0) {
+		if (NXT(len) == '/') {
+		    /* element name */
+		    lc = 1;
+		    break;
+		} else if (IS_BLANK_CH(NXT(len))) {
+		    /* ignore blanks */
+		    ;
+		} else if (NXT(len) == ':') {
+		    lc = 1;
+		    break;
+		} else if ((NXT(len) == '(')) {
+		    /* Node Type or Function */
+		    if (xmlXPathIsNodeType(name)) {
+			lc = 1;
+		    } else {
+			lc = 0;
+		    }
+                    break;
+		} else if ((NXT(len) == '[')) {
+		    /* element name */
+		    lc = 1;
+		    break;
+		} else if ((NXT(len) == '<') || (NXT(len) == '>') ||
+			   (NXT(len) == '=')) {
+		    lc = 1;
+		    break;
+		} else {
+		    lc = 1;
+		    break;
+		}
+		len++;
+	    }
+	    if (NXT(len) == 0) {
+		/* element name */
+		lc = 1;
+	    }
+	    xmlFree(name);
+	} else {
+	    /* make sure all cases are covered explicitly */
+	    XP_ERROR(XPATH_EXPR_ERROR);
+	}
+    }
+
+    if (lc) {
+	if (CUR == '/') {
+	    PUSH_LEAVE_EXPR(XPATH_OP_ROOT, 0, 0);
+	} else {
+	    PUSH_LEAVE_EXPR(XPATH_OP_NODE, 0, 0);
+	}
+	xmlXPathCompLocationPath(ctxt);
+    } else {
+	xmlXPathCompFilterExpr(ctxt);
+	CHECK_ERROR;
+	if ((CUR == '/') && (NXT(1) == '/')) {
+	    SKIP(2);
+	    SKIP_BLANKS;
 
+	    PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
+		    NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
 
-    CHECK_TYPE0(XPATH_NODESET);
-    obj = xmlXPathValuePop(ctxt);
-    /*
-    * Setup namespaces.
-    */
-    if (prefix != NULL) {
-        URI = xmlXPathNsLookup(xpctxt, prefix);
-        if (URI == NULL) {
-	    xmlXPathReleaseObject(xpctxt, obj);
-            xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
-                           "Undefined namespace prefix: %s\n", prefix);
-            return 0;
+	    xmlXPathCompRelativeLocationPath(ctxt);
+	} else if (CUR == '/') {
+	    xmlXPathCompRelativeLocationPath(ctxt);
 	}
     }
-    /*
-    * Setup axis.
-    *
-    * MAYBE FUTURE TODO: merging optimizations:
-    * - If the nodes to be traversed wrt to the initial nodes and
-    *   the current axis cannot overlap, then we could avoid searching
-    *   for duplicates during the merge.
-    *   But the question is how/when to evaluate if they cannot overlap.
-    *   Example: if we know that for two initial nodes, the one is
-    *   not in the ancestor-or-self axis of the other, then we could safely
-    *   avoid a duplicate-aware merge, if the axis to be traversed is e.g.
-    *   the descendant-or-self axis.
-    */
-    mergeAndClear = xmlXPathNodeSetMergeAndClear;
-    switch (axis) {
-        case AXIS_ANCESTOR:
-            first = NULL;
-            next = xmlXPathNextAncestor;
-            break;
-        case AXIS_ANCESTOR_OR_SELF:
-            first = NULL;
-            next = xmlXPathNextAncestorOrSelf;
-            break;
-        case AXIS_ATTRIBUTE:
-            first = NULL;
-	    last = NULL;
-            next = xmlXPathNextAttribute;
-	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
-            break;
-        case AXIS_CHILD:
-	    last = NULL;
-	    if (((test == NODE_TEST_NAME) || (test == NODE_TEST_ALL)) &&
-		(type == NODE_TYPE_NODE))
-	    {
-		/*
-		* Optimization if an element node type is 'element'.
-		*/
-		next = xmlXPathNextChildElement;
-	    } else
-		next = xmlXPathNextChild;
-	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
-            break;
-        case AXIS_DESCENDANT:
-	    last = NULL;
-            next = xmlXPathNextDescendant;
-            break;
-        case AXIS_DESCENDANT_OR_SELF:
-	    last = NULL;
-            next = xmlXPathNextDescendantOrSelf;
-            break;
-        case AXIS_FOLLOWING:
-	    last = NULL;
-            next = xmlXPathNextFollowing;
-            break;
-        case AXIS_FOLLOWING_SIBLING:
-	    last = NULL;
-            next = xmlXPathNextFollowingSibling;
-            break;
-        case AXIS_NAMESPACE:
-            first = NULL;
-	    last = NULL;
-            next = (xmlXPathTraversalFunction) xmlXPathNextNamespace;
-	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
-            break;
-        case AXIS_PARENT:
-            first = NULL;
-            next = xmlXPathNextParent;
-            break;
-        case AXIS_PRECEDING:
-            first = NULL;
-            next = xmlXPathNextPrecedingInternal;
-            break;
-        case AXIS_PRECEDING_SIBLING:
-            first = NULL;
-            next = xmlXPathNextPrecedingSibling;
-            break;
-        case AXIS_SELF:
-            first = NULL;
-	    last = NULL;
-            next = xmlXPathNextSelf;
-	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
-            break;
-    }
+    SKIP_BLANKS;
+}
 
-    if (next == NULL) {
-	xmlXPathReleaseObject(xpctxt, obj);
-        return(0);
-    }
-    contextSeq = obj->nodesetval;
-    if ((contextSeq == NULL) || (contextSeq->nodeNr <= 0)) {
-        xmlXPathValuePush(ctxt, obj);
-        return(0);
-    }
-    /*
-    * Predicate optimization ---------------------------------------------
-    * If this step has a last predicate, which contains a position(),
-    * then we'll optimize (although not exactly "position()", but only
-    * the  short-hand form, i.e., "[n]".
-    *
-    * Example - expression "/foo[parent::bar][1]":
-    *
-    * COLLECT 'child' 'name' 'node' foo    -- op (we are here)
-    *   ROOT                               -- op->ch1
-    *   PREDICATE                          -- op->ch2 (predOp)
-    *     PREDICATE                          -- predOp->ch1 = [parent::bar]
-    *       SORT
-    *         COLLECT  'parent' 'name' 'node' bar
-    *           NODE
-    *     ELEM Object is a number : 1        -- predOp->ch2 = [1]
-    *
-    */
-    maxPos = 0;
-    predOp = NULL;
-    hasPredicateRange = 0;
-    hasAxisRange = 0;
-    if (op->ch2 != -1) {
-	/*
-	* There's at least one predicate. 16 == XPATH_OP_PREDICATE
-	*/
-	predOp = &ctxt->comp->steps[op->ch2];
-	if (xmlXPathIsPositionalPredicate(ctxt, predOp, &maxPos)) {
-	    if (predOp->ch1 != -1) {
-		/*
-		* Use the next inner predicate operator.
-		*/
-		predOp = &ctxt->comp->steps[predOp->ch1];
-		hasPredicateRange = 1;
-	    } else {
-		/*
-		* There's no other predicate than the [n] predicate.
-		*/
-		predOp = NULL;
-		hasAxisRange = 1;
-	    }
-	}
+/**
+ *  [18]   UnionExpr ::=   PathExpr
+ *               | UnionExpr '|' PathExpr
+ *
+ * Compile an union expression.
+ *
+ * @param ctxt  the XPath Parser context
+ */
+
+static void
+xmlXPathCompUnionExpr(xmlXPathParserContextPtr ctxt) {
+    xmlXPathCompPathExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while (CUR == '|') {
+	int op1 = ctxt->comp->last;
+	PUSH_LEAVE_EXPR(XPATH_OP_NODE, 0, 0);
+
+	NEXT;
+	SKIP_BLANKS;
+	xmlXPathCompPathExpr(ctxt);
+
+	PUSH_BINARY_EXPR(XPATH_OP_UNION, op1, ctxt->comp->last, 0, 0);
+
+	SKIP_BLANKS;
     }
-    breakOnFirstHit = ((toBool) && (predOp == NULL)) ? 1 : 0;
-    /*
-    * Axis traversal -----------------------------------------------------
-    */
-    /*
-     * 2.3 Node Tests
-     *  - For the attribute axis, the principal node type is attribute.
-     *  - For the namespace axis, the principal node type is namespace.
-     *  - For other axes, the principal node type is element.
-     *
-     * A node test * is true for any node of the
-     * principal node type. For example, child::* will
-     * select all element children of the context node
-     */
-    oldContextNode = xpctxt->node;
-    addNode = xmlXPathNodeSetAddUnique;
-    outSeq = NULL;
-    seq = NULL;
-    contextNode = NULL;
-    contextIdx = 0;
+}
 
+/**
+ *  [27]   UnaryExpr ::=   UnionExpr
+ *                   | '-' UnaryExpr
+ *
+ * Compile an unary expression.
+ *
+ * @param ctxt  the XPath Parser context
+ */
 
-    while (((contextIdx < contextSeq->nodeNr) || (contextNode != NULL)) &&
-           (ctxt->error == XPATH_EXPRESSION_OK)) {
-	xpctxt->node = contextSeq->nodeTab[contextIdx++];
+static void
+xmlXPathCompUnaryExpr(xmlXPathParserContextPtr ctxt) {
+    int minus = 0;
+    int found = 0;
 
-	if (seq == NULL) {
-	    seq = xmlXPathNodeSetCreate(NULL);
-	    if (seq == NULL) {
-                xmlXPathPErrMemory(ctxt);
-		total = 0;
-		goto error;
-	    }
+    SKIP_BLANKS;
+    while (CUR == '-') {
+        minus = 1 - minus;
+	found = 1;
+	NEXT;
+	SKIP_BLANKS;
+    }
+
+    xmlXPathCompUnionExpr(ctxt);
+    CHECK_ERROR;
+    if (found) {
+	if (minus)
+	    PUSH_UNARY_EXPR(XPATH_OP_PLUS, ctxt->comp->last, 2, 0);
+	else
+	    PUSH_UNARY_EXPR(XPATH_OP_PLUS, ctxt->comp->last, 3, 0);
+    }
+}
+
+/**
+ *  [26]   MultiplicativeExpr ::=   UnaryExpr
+ *                   | MultiplicativeExpr MultiplyOperator UnaryExpr
+ *                   | MultiplicativeExpr 'div' UnaryExpr
+ *                   | MultiplicativeExpr 'mod' UnaryExpr
+ *  [34]   MultiplyOperator ::=   '*'
+ *
+ * Compile an Additive expression.
+ *
+ * @param ctxt  the XPath Parser context
+ */
+
+static void
+xmlXPathCompMultiplicativeExpr(xmlXPathParserContextPtr ctxt) {
+    xmlXPathCompUnaryExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while ((CUR == '*') ||
+           ((CUR == 'd') && (NXT(1) == 'i') && (NXT(2) == 'v')) ||
+           ((CUR == 'm') && (NXT(1) == 'o') && (NXT(2) == 'd'))) {
+	int op = -1;
+	int op1 = ctxt->comp->last;
+
+        if (CUR == '*') {
+	    op = 0;
+	    NEXT;
+	} else if (CUR == 'd') {
+	    op = 1;
+	    SKIP(3);
+	} else if (CUR == 'm') {
+	    op = 2;
+	    SKIP(3);
 	}
-	/*
-	* Traverse the axis and test the nodes.
-	*/
-	pos = 0;
-	cur = NULL;
-	hasNsNodes = 0;
-        do {
-            if (OP_LIMIT_EXCEEDED(ctxt, 1))
-                goto error;
+	SKIP_BLANKS;
+        xmlXPathCompUnaryExpr(ctxt);
+	CHECK_ERROR;
+	PUSH_BINARY_EXPR(XPATH_OP_MULT, op1, ctxt->comp->last, op, 0);
+	SKIP_BLANKS;
+    }
+}
 
-            cur = next(ctxt, cur);
-            if (cur == NULL)
-                break;
+/**
+ *  [25]   AdditiveExpr ::=   MultiplicativeExpr
+ *                   | AdditiveExpr '+' MultiplicativeExpr
+ *                   | AdditiveExpr '-' MultiplicativeExpr
+ *
+ * Compile an Additive expression.
+ *
+ * @param ctxt  the XPath Parser context
+ */
 
-	    /*
-	    * QUESTION TODO: What does the "first" and "last" stuff do?
-	    */
-            if ((first != NULL) && (*first != NULL)) {
-		if (*first == cur)
-		    break;
-		if (((total % 256) == 0) &&
-#ifdef XP_OPTIMIZED_NON_ELEM_COMPARISON
-		    (xmlXPathCmpNodesExt(*first, cur) >= 0))
-#else
-		    (xmlXPathCmpNodes(*first, cur) >= 0))
-#endif
-		{
-		    break;
-		}
-	    }
-	    if ((last != NULL) && (*last != NULL)) {
-		if (*last == cur)
-		    break;
-		if (((total % 256) == 0) &&
-#ifdef XP_OPTIMIZED_NON_ELEM_COMPARISON
-		    (xmlXPathCmpNodesExt(cur, *last) >= 0))
-#else
-		    (xmlXPathCmpNodes(cur, *last) >= 0))
-#endif
-		{
-		    break;
-		}
-	    }
+static void
+xmlXPathCompAdditiveExpr(xmlXPathParserContextPtr ctxt) {
 
-            total++;
+    xmlXPathCompMultiplicativeExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while ((CUR == '+') || (CUR == '-')) {
+	int plus;
+	int op1 = ctxt->comp->last;
 
-	    switch (test) {
-                case NODE_TEST_NONE:
-		    total = 0;
-		    goto error;
-                case NODE_TEST_TYPE:
-		    if (type == NODE_TYPE_NODE) {
-			switch (cur->type) {
-			    case XML_DOCUMENT_NODE:
-			    case XML_HTML_DOCUMENT_NODE:
-			    case XML_ELEMENT_NODE:
-			    case XML_ATTRIBUTE_NODE:
-			    case XML_PI_NODE:
-			    case XML_COMMENT_NODE:
-			    case XML_CDATA_SECTION_NODE:
-			    case XML_TEXT_NODE:
-				XP_TEST_HIT
-				break;
-			    case XML_NAMESPACE_DECL: {
-				if (axis == AXIS_NAMESPACE) {
-				    XP_TEST_HIT_NS
-				} else {
-	                            hasNsNodes = 1;
-				    XP_TEST_HIT
-				}
-				break;
-                            }
-			    default:
-				break;
-			}
-		    } else if (cur->type == (xmlElementType) type) {
-			if (cur->type == XML_NAMESPACE_DECL)
-			    XP_TEST_HIT_NS
-			else
-			    XP_TEST_HIT
-		    } else if ((type == NODE_TYPE_TEXT) &&
+        if (CUR == '+') plus = 1;
+	else plus = 0;
+	NEXT;
+	SKIP_BLANKS;
+        xmlXPathCompMultiplicativeExpr(ctxt);
+	CHECK_ERROR;
+	PUSH_BINARY_EXPR(XPATH_OP_PLUS, op1, ctxt->comp->last, plus, 0);
+	SKIP_BLANKS;
+    }
+}
+
+/**
+ *  [24]   RelationalExpr ::=   AdditiveExpr
+ *                 | RelationalExpr '<' AdditiveExpr
+ *                 | RelationalExpr '>' AdditiveExpr
+ *                 | RelationalExpr '<=' AdditiveExpr
+ *                 | RelationalExpr '>=' AdditiveExpr
+ *
+ *  A <= B > C is allowed ? Answer from James, yes with
+ *  (AdditiveExpr <= AdditiveExpr) > AdditiveExpr
+ *  which is basically what got implemented.
+ *
+ * Compile a Relational expression, then push the result
+ * on the stack
+ *
+ * @param ctxt  the XPath Parser context
+ */
+
+static void
+xmlXPathCompRelationalExpr(xmlXPathParserContextPtr ctxt) {
+    xmlXPathCompAdditiveExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while ((CUR == '<') || (CUR == '>')) {
+	int inf, strict;
+	int op1 = ctxt->comp->last;
+
+        if (CUR == '<') inf = 1;
+	else inf = 0;
+	if (NXT(1) == '=') strict = 0;
+	else strict = 1;
+	NEXT;
+	if (!strict) NEXT;
+	SKIP_BLANKS;
+        xmlXPathCompAdditiveExpr(ctxt);
+	CHECK_ERROR;
+	PUSH_BINARY_EXPR(XPATH_OP_CMP, op1, ctxt->comp->last, inf, strict);
+	SKIP_BLANKS;
+    }
+}
+
+/**
+ *  [23]   EqualityExpr ::=   RelationalExpr
+ *                 | EqualityExpr '=' RelationalExpr
+ *                 | EqualityExpr '!=' RelationalExpr
+ *
+ *  A != B != C is allowed ? Answer from James, yes with
+ *  (RelationalExpr = RelationalExpr) = RelationalExpr
+ *  (RelationalExpr != RelationalExpr) != RelationalExpr
+ *  which is basically what got implemented.
+ *
+ * Compile an Equality expression.
+ *
+ * @param ctxt  the XPath Parser context
+ */
+static void
+xmlXPathCompEqualityExpr(xmlXPathParserContextPtr ctxt) {
+    xmlXPathCompRelationalExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while ((CUR == '=') || ((CUR == '!') && (NXT(1) == '='))) {
+	int eq;
+	int op1 = ctxt->comp->last;
+
+        if (CUR == '=') eq = 1;
+	else eq = 0;
+	NEXT;
+	if (!eq) NEXT;
+	SKIP_BLANKS;
+        xmlXPathCompRelationalExpr(ctxt);
+	CHECK_ERROR;
+	PUSH_BINARY_EXPR(XPATH_OP_EQUAL, op1, ctxt->comp->last, eq, 0);
+	SKIP_BLANKS;
+    }
+}
+
+/**
+ *  [22]   AndExpr ::=   EqualityExpr
+ *                 | AndExpr 'and' EqualityExpr
+ *
+ * Compile an AND expression.
+ *
+ * @param ctxt  the XPath Parser context
+ */
+static void
+xmlXPathCompAndExpr(xmlXPathParserContextPtr ctxt) {
+    xmlXPathCompEqualityExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while ((CUR == 'a') && (NXT(1) == 'n') && (NXT(2) == 'd')) {
+	int op1 = ctxt->comp->last;
+        SKIP(3);
+	SKIP_BLANKS;
+        xmlXPathCompEqualityExpr(ctxt);
+	CHECK_ERROR;
+	PUSH_BINARY_EXPR(XPATH_OP_AND, op1, ctxt->comp->last, 0, 0);
+	SKIP_BLANKS;
+    }
+}
+
+/**
+ *  [14]   Expr ::=   OrExpr
+ *  [21]   OrExpr ::=   AndExpr
+ *                 | OrExpr 'or' AndExpr
+ *
+ * Parse and compile an expression
+ *
+ * @param ctxt  the XPath Parser context
+ * @param sort  whether to sort the resulting node set
+ */
+static void
+xmlXPathCompileExpr(xmlXPathParserContextPtr ctxt, int sort) {
+    xmlXPathContextPtr xpctxt = ctxt->context;
+
+    if (xpctxt != NULL) {
+        if (xpctxt->depth >= XPATH_MAX_RECURSION_DEPTH)
+            XP_ERROR(XPATH_RECURSION_LIMIT_EXCEEDED);
+        /*
+         * Parsing a single '(' pushes about 10 functions on the call stack
+         * before recursing!
+         */
+        xpctxt->depth += 10;
+    }
+
+    xmlXPathCompAndExpr(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while ((CUR == 'o') && (NXT(1) == 'r')) {
+	int op1 = ctxt->comp->last;
+        SKIP(2);
+	SKIP_BLANKS;
+        xmlXPathCompAndExpr(ctxt);
+	CHECK_ERROR;
+	PUSH_BINARY_EXPR(XPATH_OP_OR, op1, ctxt->comp->last, 0, 0);
+	SKIP_BLANKS;
+    }
+    if ((sort) && (ctxt->comp->steps[ctxt->comp->last].op != XPATH_OP_VALUE)) {
+	/* more ops could be optimized too */
+	/*
+	* This is the main place to eliminate sorting for
+	* operations which don't require a sorted node-set.
+	* E.g. count().
+	*/
+	PUSH_UNARY_EXPR(XPATH_OP_SORT, ctxt->comp->last , 0, 0);
+    }
+
+    if (xpctxt != NULL)
+        xpctxt->depth -= 10;
+}
+
+/**
+ *  [8]   Predicate ::=   '[' PredicateExpr ']'
+ *  [9]   PredicateExpr ::=   Expr
+ *
+ * Compile a predicate expression
+ *
+ * @param ctxt  the XPath Parser context
+ * @param filter  act as a filter
+ */
+static void
+xmlXPathCompPredicate(xmlXPathParserContextPtr ctxt, int filter) {
+    int op1 = ctxt->comp->last;
+
+    SKIP_BLANKS;
+    if (CUR != '[') {
+	XP_ERROR(XPATH_INVALID_PREDICATE_ERROR);
+    }
+    NEXT;
+    SKIP_BLANKS;
+
+    ctxt->comp->last = -1;
+    /*
+    * This call to xmlXPathCompileExpr() will deactivate sorting
+    * of the predicate result.
+    * TODO: Sorting is still activated for filters, since I'm not
+    *  sure if needed. Normally sorting should not be needed, since
+    *  a filter can only diminish the number of items in a sequence,
+    *  but won't change its order; so if the initial sequence is sorted,
+    *  subsequent sorting is not needed.
+    */
+    if (! filter)
+	xmlXPathCompileExpr(ctxt, 0);
+    else
+	xmlXPathCompileExpr(ctxt, 1);
+    CHECK_ERROR;
+
+    if (CUR != ']') {
+	XP_ERROR(XPATH_INVALID_PREDICATE_ERROR);
+    }
+
+    if (filter)
+	PUSH_BINARY_EXPR(XPATH_OP_FILTER, op1, ctxt->comp->last, 0, 0);
+    else
+	PUSH_BINARY_EXPR(XPATH_OP_PREDICATE, op1, ctxt->comp->last, 0, 0);
+
+    NEXT;
+    SKIP_BLANKS;
+}
+
+/**
+ * ```
+ * [7] NodeTest ::=   NameTest
+ *		    | NodeType '(' ')'
+ *		    | 'processing-instruction' '(' Literal ')'
+ *
+ * [37] NameTest ::=  '*'
+ *		    | NCName ':' '*'
+ *		    | QName
+ * [38] NodeType ::= 'comment'
+ *		   | 'text'
+ *		   | 'processing-instruction'
+ *		   | 'node'
+ * ```
+ *
+ * @param ctxt  the XPath Parser context
+ * @param test  pointer to a xmlXPathTestVal
+ * @param type  pointer to a xmlXPathTypeVal
+ * @param prefix  placeholder for a possible name prefix
+ * @param name  current name token (optional)
+ * @returns the name found and updates `test`, `type` and `prefix` appropriately
+ */
+static xmlChar *
+xmlXPathCompNodeTest(xmlXPathParserContextPtr ctxt, xmlXPathTestVal *test,
+	             xmlXPathTypeVal *type, xmlChar **prefix,
+		     xmlChar *name) {
+    int blanks;
+
+    if ((test == NULL) || (type == NULL) || (prefix == NULL)) {
+	return(NULL);
+    }
+    *type = (xmlXPathTypeVal) 0;
+    *test = (xmlXPathTestVal) 0;
+    *prefix = NULL;
+    SKIP_BLANKS;
+
+    if ((name == NULL) && (CUR == '*')) {
+	/*
+	 * All elements
+	 */
+	NEXT;
+	*test = NODE_TEST_ALL;
+	return(NULL);
+    }
+
+    if (name == NULL)
+	name = xmlXPathParseNCName(ctxt);
+    if (name == NULL) {
+	XP_ERRORNULL(XPATH_EXPR_ERROR);
+    }
+
+    blanks = IS_BLANK_CH(CUR);
+    SKIP_BLANKS;
+    if (CUR == '(') {
+	NEXT;
+	/*
+	 * NodeType or PI search
+	 */
+	if (xmlStrEqual(name, BAD_CAST "comment"))
+	    *type = NODE_TYPE_COMMENT;
+	else if (xmlStrEqual(name, BAD_CAST "node"))
+	    *type = NODE_TYPE_NODE;
+	else if (xmlStrEqual(name, BAD_CAST "processing-instruction"))
+	    *type = NODE_TYPE_PI;
+	else if (xmlStrEqual(name, BAD_CAST "text"))
+	    *type = NODE_TYPE_TEXT;
+	else {
+	    if (name != NULL)
+		xmlFree(name);
+	    XP_ERRORNULL(XPATH_EXPR_ERROR);
+	}
+
+	*test = NODE_TEST_TYPE;
+
+	SKIP_BLANKS;
+	if (*type == NODE_TYPE_PI) {
+	    /*
+	     * Specific case: search a PI by name.
+	     */
+	    if (name != NULL)
+		xmlFree(name);
+	    name = NULL;
+	    if (CUR != ')') {
+		name = xmlXPathParseLiteral(ctxt);
+		*test = NODE_TEST_PI;
+		SKIP_BLANKS;
+	    }
+	}
+	if (CUR != ')') {
+	    if (name != NULL)
+		xmlFree(name);
+	    XP_ERRORNULL(XPATH_UNCLOSED_ERROR);
+	}
+	NEXT;
+	return(name);
+    }
+    *test = NODE_TEST_NAME;
+    if ((!blanks) && (CUR == ':')) {
+	NEXT;
+
+	/*
+	 * Since currently the parser context don't have a
+	 * namespace list associated:
+	 * The namespace name for this prefix can be computed
+	 * only at evaluation time. The compilation is done
+	 * outside of any context.
+	 */
+	*prefix = name;
+
+	if (CUR == '*') {
+	    /*
+	     * All elements
+	     */
+	    NEXT;
+	    *test = NODE_TEST_ALL;
+	    return(NULL);
+	}
+
+	name = xmlXPathParseNCName(ctxt);
+	if (name == NULL) {
+	    XP_ERRORNULL(XPATH_EXPR_ERROR);
+	}
+    }
+    return(name);
+}
+
+/**
+ * [6] AxisName ::=   'ancestor'
+ *                  | 'ancestor-or-self'
+ *                  | 'attribute'
+ *                  | 'child'
+ *                  | 'descendant'
+ *                  | 'descendant-or-self'
+ *                  | 'following'
+ *                  | 'following-sibling'
+ *                  | 'namespace'
+ *                  | 'parent'
+ *                  | 'preceding'
+ *                  | 'preceding-sibling'
+ *                  | 'self'
+ *
+ * @param name  a preparsed name token
+ * @returns the axis or 0
+ */
+static xmlXPathAxisVal
+xmlXPathIsAxisName(const xmlChar *name) {
+    xmlXPathAxisVal ret = (xmlXPathAxisVal) 0;
+    switch (name[0]) {
+	case 'a':
+	    if (xmlStrEqual(name, BAD_CAST "ancestor"))
+		ret = AXIS_ANCESTOR;
+	    if (xmlStrEqual(name, BAD_CAST "ancestor-or-self"))
+		ret = AXIS_ANCESTOR_OR_SELF;
+	    if (xmlStrEqual(name, BAD_CAST "attribute"))
+		ret = AXIS_ATTRIBUTE;
+	    break;
+	case 'c':
+	    if (xmlStrEqual(name, BAD_CAST "child"))
+		ret = AXIS_CHILD;
+	    break;
+	case 'd':
+	    if (xmlStrEqual(name, BAD_CAST "descendant"))
+		ret = AXIS_DESCENDANT;
+	    if (xmlStrEqual(name, BAD_CAST "descendant-or-self"))
+		ret = AXIS_DESCENDANT_OR_SELF;
+	    break;
+	case 'f':
+	    if (xmlStrEqual(name, BAD_CAST "following"))
+		ret = AXIS_FOLLOWING;
+	    if (xmlStrEqual(name, BAD_CAST "following-sibling"))
+		ret = AXIS_FOLLOWING_SIBLING;
+	    break;
+	case 'n':
+	    if (xmlStrEqual(name, BAD_CAST "namespace"))
+		ret = AXIS_NAMESPACE;
+	    break;
+	case 'p':
+	    if (xmlStrEqual(name, BAD_CAST "parent"))
+		ret = AXIS_PARENT;
+	    if (xmlStrEqual(name, BAD_CAST "preceding"))
+		ret = AXIS_PRECEDING;
+	    if (xmlStrEqual(name, BAD_CAST "preceding-sibling"))
+		ret = AXIS_PRECEDING_SIBLING;
+	    break;
+	case 's':
+	    if (xmlStrEqual(name, BAD_CAST "self"))
+		ret = AXIS_SELF;
+	    break;
+    }
+    return(ret);
+}
+
+/**
+ * [4] Step ::=   AxisSpecifier NodeTest Predicate*
+ *                  | AbbreviatedStep
+ *
+ * [12] AbbreviatedStep ::=   '.' | '..'
+ *
+ * [5] AxisSpecifier ::= AxisName '::'
+ *                  | AbbreviatedAxisSpecifier
+ *
+ * [13] AbbreviatedAxisSpecifier ::= '@'?
+ *
+ * Modified for XPtr range support as:
+ *
+ *  [4xptr] Step ::= AxisSpecifier NodeTest Predicate*
+ *                     | AbbreviatedStep
+ *                     | 'range-to' '(' Expr ')' Predicate*
+ *
+ * Compile one step in a Location Path
+ *
+ * @param ctxt  the XPath Parser context
+ */
+static void
+xmlXPathCompStep(xmlXPathParserContextPtr ctxt) {
+    SKIP_BLANKS;
+    if ((CUR == '.') && (NXT(1) == '.')) {
+	SKIP(2);
+	SKIP_BLANKS;
+	PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_PARENT,
+		    NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
+    } else if (CUR == '.') {
+	NEXT;
+	SKIP_BLANKS;
+    } else {
+	xmlChar *name = NULL;
+	xmlChar *prefix = NULL;
+	xmlXPathTestVal test = (xmlXPathTestVal) 0;
+	xmlXPathAxisVal axis = (xmlXPathAxisVal) 0;
+	xmlXPathTypeVal type = (xmlXPathTypeVal) 0;
+	int op1;
+
+	if (CUR == '*') {
+	    axis = AXIS_CHILD;
+	} else {
+	    if (name == NULL)
+		name = xmlXPathParseNCName(ctxt);
+	    if (name != NULL) {
+		axis = xmlXPathIsAxisName(name);
+		if (axis != 0) {
+		    SKIP_BLANKS;
+		    if ((CUR == ':') && (NXT(1) == ':')) {
+			SKIP(2);
+			xmlFree(name);
+			name = NULL;
+		    } else {
+			/* an element name can conflict with an axis one :-\ */
+			axis = AXIS_CHILD;
+		    }
+		} else {
+		    axis = AXIS_CHILD;
+		}
+	    } else if (CUR == '@') {
+		NEXT;
+		axis = AXIS_ATTRIBUTE;
+	    } else {
+		axis = AXIS_CHILD;
+	    }
+	}
+
+        if (ctxt->error != XPATH_EXPRESSION_OK) {
+            xmlFree(name);
+            return;
+        }
+
+	name = xmlXPathCompNodeTest(ctxt, &test, &type, &prefix, name);
+	if (test == 0)
+	    return;
+
+        if ((prefix != NULL) && (ctxt->context != NULL) &&
+	    (ctxt->context->flags & XML_XPATH_CHECKNS)) {
+	    if (xmlXPathNsLookup(ctxt->context, prefix) == NULL) {
+		xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
+                               "Undefined namespace prefix: %s\n", prefix);
+	    }
+	}
+
+	op1 = ctxt->comp->last;
+	ctxt->comp->last = -1;
+
+	SKIP_BLANKS;
+	while (CUR == '[') {
+	    xmlXPathCompPredicate(ctxt, 0);
+	}
+
+        if (PUSH_FULL_EXPR(XPATH_OP_COLLECT, op1, ctxt->comp->last, axis,
+                           test, type, (void *)prefix, (void *)name) == -1) {
+            xmlFree(prefix);
+            xmlFree(name);
+        }
+    }
+}
+
+/**
+ *  [3]   RelativeLocationPath ::=   Step
+ *                     | RelativeLocationPath '/' Step
+ *                     | AbbreviatedRelativeLocationPath
+ *  [11]  AbbreviatedRelativeLocationPath ::=   RelativeLocationPath '//' Step
+ *
+ * Compile a relative location path.
+ *
+ * @param ctxt  the XPath Parser context
+ */
+static void
+xmlXPathCompRelativeLocationPath
+(xmlXPathParserContextPtr ctxt) {
+    SKIP_BLANKS;
+    if ((CUR == '/') && (NXT(1) == '/')) {
+	SKIP(2);
+	SKIP_BLANKS;
+	PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
+		         NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
+    } else if (CUR == '/') {
+	    NEXT;
+	SKIP_BLANKS;
+    }
+    xmlXPathCompStep(ctxt);
+    CHECK_ERROR;
+    SKIP_BLANKS;
+    while (CUR == '/') {
+	if ((CUR == '/') && (NXT(1) == '/')) {
+	    SKIP(2);
+	    SKIP_BLANKS;
+	    PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
+			     NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
+	    xmlXPathCompStep(ctxt);
+	} else if (CUR == '/') {
+	    NEXT;
+	    SKIP_BLANKS;
+	    xmlXPathCompStep(ctxt);
+	}
+	SKIP_BLANKS;
+    }
+}
+
+/**
+ *  [1]   LocationPath ::=   RelativeLocationPath
+ *                     | AbsoluteLocationPath
+ *  [2]   AbsoluteLocationPath ::=   '/' RelativeLocationPath?
+ *                     | AbbreviatedAbsoluteLocationPath
+ *  [10]   AbbreviatedAbsoluteLocationPath ::=
+ *                           '//' RelativeLocationPath
+ *
+ * Compile a location path
+ *
+ * @param ctxt  the XPath Parser context
+ */
+static void
+xmlXPathCompLocationPath(xmlXPathParserContextPtr ctxt) {
+    SKIP_BLANKS;
+    if (CUR != '/') {
+        xmlXPathCompRelativeLocationPath(ctxt);
+    } else {
+	while (CUR == '/') {
+	    if ((CUR == '/') && (NXT(1) == '/')) {
+		SKIP(2);
+		SKIP_BLANKS;
+		PUSH_LONG_EXPR(XPATH_OP_COLLECT, AXIS_DESCENDANT_OR_SELF,
+			     NODE_TEST_TYPE, NODE_TYPE_NODE, NULL, NULL);
+		xmlXPathCompRelativeLocationPath(ctxt);
+	    } else if (CUR == '/') {
+		NEXT;
+		SKIP_BLANKS;
+		if ((CUR != 0) &&
+		    ((IS_ASCII_LETTER(CUR)) || (CUR >= 0x80) ||
+                     (CUR == '_') || (CUR == '.') ||
+		     (CUR == '@') || (CUR == '*')))
+		    xmlXPathCompRelativeLocationPath(ctxt);
+	    }
+	    CHECK_ERROR;
+	}
+    }
+}
+
+/************************************************************************
+ *									*
+ *		XPath precompiled expression evaluation			*
+ *									*
+ ************************************************************************/
+
+static int
+xmlXPathCompOpEval(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op);
+
+#ifdef XPATH_PARALLEL
+
+typedef struct {
+    xmlXPathContext ctxt;
+    xmlXPathParserContextPtr pctxt;
+    xmlNodeSetPtr set;
+    xmlXPathStepOpPtr op;
+    char *keep;
+    int start;
+    int end;
+    int started;
+} xmlXPathFilterWorker;
+
+/*
+ * Check that the functions called in an expression can be resolved,
+ * so that lookup errors are reported by the calling thread. Returns
+ * 0 on success, -1 if a function can't be resolved.
+ */
+static int
+xmlXPathResolveFunctions(xmlXPathParserContextPtr ctxt,
+                         xmlXPathStepOpPtr op) {
+    xmlXPathCompExprPtr comp = ctxt->comp;
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    int ret = 0;
+
+    if ((op->op == XPATH_OP_FUNCTION) && (op->cache == NULL)) {
+        const xmlChar *URI;
+        xmlXPathFunction func;
+
+        if (op->value5 == NULL) {
+            func = xmlXPathFunctionLookup(xpctxt, op->value4);
+        } else {
+            URI = xmlXPathNsLookup(xpctxt, op->value5);
+            if (URI == NULL)
+                return(-1);
+            func = xmlXPathFunctionLookupNS(xpctxt, op->value4, URI);
+        }
+        if (func == NULL)
+            return(-1);
+    }
+
+    /* OP_VALUE has invalid ch1. */
+    if (op->op == XPATH_OP_VALUE)
+        return(0);
+
+    if (xpctxt->depth >= XPATH_MAX_RECURSION_DEPTH)
+        return(-1);
+    xpctxt->depth += 1;
+    if ((op->ch1 != -1) &&
+        (xmlXPathResolveFunctions(ctxt, &comp->steps[op->ch1]) < 0))
+        ret = -1;
+    else if ((op->ch2 != -1) &&
+             (xmlXPathResolveFunctions(ctxt, &comp->steps[op->ch2]) < 0))
+        ret = -1;
+    xpctxt->depth -= 1;
+
+    return(ret);
+}
+
+static void
+xmlXPathFilterWorkerRun(void *data) {
+    xmlXPathFilterWorker *worker = data;
+    xmlXPathParserContextPtr pctxt = worker->pctxt;
+    xmlXPathContextPtr xpctxt = &worker->ctxt;
+    int i;
+
+    for (i = worker->start; i < worker->end; i++) {
+        xmlNodePtr node = worker->set->nodeTab[i];
+        int res;
+
+        xpctxt->node = node;
+        xpctxt->proximityPosition = i + 1;
+        if (node->doc != NULL)
+            xpctxt->doc = node->doc;
+
+        res = xmlXPathCompOpEvalToBoolean(pctxt, worker->op, 1);
+
+        if (pctxt->error != XPATH_EXPRESSION_OK)
+            break;
+        if (res < 0) {
+            xmlXPathErr(pctxt, XPATH_EXPR_ERROR);
+            break;
+        }
+
+        worker->keep[i] = (res != 0);
+    }
+}
+
+/*
+ * Evaluate a predicate for all nodes of a set with multiple threads.
+ * Each thread works on a chunk of the set with a copy of the XPath
+ * context and its own object cache.
+ *
+ * Returns an array with a non-zero entry for each node to keep, or
+ * NULL if the set can't be filtered in parallel. Errors are raised
+ * on `ctxt`.
+ */
+static char *
+xmlXPathNodeSetFilterParallel(xmlXPathParserContextPtr ctxt,
+                              xmlNodeSetPtr set, xmlXPathStepOpPtr op) {
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    xmlXPathFilterWorker *workers;
+    xmlTaskGroup *group;
+    xmlDocPtr doc;
+    void *docIndex;
+    char *keep;
+    unsigned long opCount;
+    int nbWorkers, chunk, i;
+    int error = XPATH_EXPRESSION_OK;
+
+    /*
+     * Documents, lazily built indexes and memory budgets aren't
+     * shared safely between threads.
+     */
+    if ((xpctxt->memBudget != NULL) || (xpctxt->keys != NULL))
+        return(NULL);
+    doc = set->nodeTab[0]->doc;
+    for (i = 0; i < set->nodeNr; i++) {
+        if ((set->nodeTab[i]->type == XML_NAMESPACE_DECL) ||
+            (set->nodeTab[i]->doc != doc))
+            return(NULL);
+    }
+
+    /*
+     * id() would build the ID table of a document with lazy IDs
+     * from the workers.
+     */
+    if ((doc != NULL) && (doc->properties & XML_DOC_LAZY_IDS) &&
+        (xmlCollectLazyIds(doc) < 0))
+        return(NULL);
+
+    if (xmlXPathResolveFunctions(ctxt, op) < 0)
+        return(NULL);
+
+    nbWorkers = xpctxt->parallelThreads;
+    if (nbWorkers > set->nodeNr / XPATH_PARALLEL_MIN_CHUNK)
+        nbWorkers = set->nodeNr / XPATH_PARALLEL_MIN_CHUNK;
+    if (nbWorkers < 2)
+        return(NULL);
+    chunk = (set->nodeNr + nbWorkers - 1) / nbWorkers;
+
+    keep = xmlMalloc(set->nodeNr);
+    if (keep == NULL)
+        return(NULL);
+    memset(keep, 0, set->nodeNr);
+    workers = xmlMalloc(nbWorkers * sizeof(workers[0]));
+    if (workers == NULL) {
+        xmlFree(keep);
+        return(NULL);
+    }
+
+    for (i = 0; i < nbWorkers; i++) {
+        xmlXPathFilterWorker *worker = &workers[i];
+
+        memcpy(&worker->ctxt, xpctxt, sizeof(worker->ctxt));
+        worker->ctxt.cache = NULL;
+        worker->ctxt.exprCache = NULL;
+        worker->ctxt.parallelThreads = 0;
+        worker->ctxt.flags &= ~XML_XPATH_PROFILE;
+        worker->ctxt.contextSize = set->nodeNr;
+        memset(&worker->ctxt.lastError, 0, sizeof(worker->ctxt.lastError));
+        xmlXPathContextSetCache(&worker->ctxt, 1, -1, 0);
+
+        worker->pctxt = xmlXPathCompParserContext(ctxt->comp, &worker->ctxt);
+        worker->set = set;
+        worker->op = op;
+        worker->keep = keep;
+        worker->start = i * chunk;
+        worker->end = worker->start + chunk;
+        if (worker->end > set->nodeNr)
+            worker->end = set->nodeNr;
+        worker->started = 0;
+    }
+
+    /*
+     * Workers evaluate without the name index unless the document is
+     * frozen and the index can be shared.
+     */
+    opCount = xpctxt->opCount;
+    docIndex = NULL;
+    if ((doc != NULL) && ((doc->properties & XML_DOC_FROZEN) == 0)) {
+        docIndex = doc->nameIndex;
+        doc->nameIndex = NULL;
+    }
+
+    /*
+     * The calling thread handles the first chunk and the chunks which
+     * couldn't be submitted.
+     */
+    group = xmlNewTaskGroup();
+    for (i = 1; i < nbWorkers; i++) {
+        if ((workers[i].pctxt != NULL) &&
+            (xmlTaskGroupSubmit(group, xmlXPathFilterWorkerRun,
+                                &workers[i]) == 0))
+            workers[i].started = 1;
+    }
+    for (i = 0; i < nbWorkers; i++) {
+        if ((!workers[i].started) && (workers[i].pctxt != NULL))
+            xmlXPathFilterWorkerRun(&workers[i]);
+    }
+    xmlFreeTaskGroup(group);
+
+    for (i = 0; i < nbWorkers; i++) {
+        xmlXPathFilterWorker *worker = &workers[i];
+
+        /* Report the first error in document order. */
+        if (worker->pctxt == NULL) {
+            if (error == XPATH_EXPRESSION_OK)
+                error = XPATH_MEMORY_ERROR;
+        } else if ((error == XPATH_EXPRESSION_OK) &&
+                   (worker->pctxt->error != XPATH_EXPRESSION_OK)) {
+            error = worker->pctxt->error;
+            xmlResetError(&xpctxt->lastError);
+            xmlCopyError(&worker->ctxt.lastError, &xpctxt->lastError);
+        }
+        xpctxt->opCount += worker->ctxt.opCount - opCount;
+
+        if (worker->pctxt != NULL) {
+            worker->pctxt->comp = NULL;
+            xmlXPathFreeParserContext(worker->pctxt);
+        }
+        xmlXPathContextSetCache(&worker->ctxt, 0, -1, 0);
+        xmlResetError(&worker->ctxt.lastError);
+    }
+
+    if (docIndex != NULL)
+        doc->nameIndex = docIndex;
+    xmlFree(workers);
+
+    if (error == XPATH_MEMORY_ERROR)
+        xmlXPathPErrMemory(ctxt);
+    else if (error != XPATH_EXPRESSION_OK)
+        ctxt->error = error;
+    else if ((xpctxt->opLimit != 0) && (xpctxt->opCount > xpctxt->opLimit))
+        xmlXPathErr(ctxt, XPATH_OP_LIMIT_EXCEEDED);
+
+    return(keep);
+}
+
+#endif /* XPATH_PARALLEL */
+
+/**
+ * Filter a node set, keeping only nodes for which the predicate expression
+ * matches. Afterwards, keep only nodes between minPos and maxPos in the
+ * filtered result.
+ *
+ * @param ctxt  the XPath Parser context
+ * @param set  the node set to filter
+ * @param filterOpIndex  the index of the predicate/filter op
+ * @param minPos  minimum position in the filtered set (1-based)
+ * @param maxPos  maximum position in the filtered set (1-based)
+ * @param hasNsNodes  true if the node set may contain namespace nodes
+ */
+static void
+xmlXPathNodeSetFilter(xmlXPathParserContextPtr ctxt,
+		      xmlNodeSetPtr set,
+		      int filterOpIndex,
+                      int minPos, int maxPos,
+		      int hasNsNodes)
+{
+    xmlXPathContextPtr xpctxt;
+    xmlNodePtr oldnode;
+    xmlDocPtr olddoc;
+    xmlXPathStepOpPtr filterOp;
+    int oldcs, oldpp;
+    int i, j, pos;
+
+    if ((set == NULL) || (set->nodeNr == 0))
+        return;
+
+    /*
+    * Check if the node set contains a sufficient number of nodes for
+    * the requested range.
+    */
+    if (set->nodeNr < minPos) {
+        xmlXPathNodeSetClear(set, hasNsNodes);
+        return;
+    }
+
+    xpctxt = ctxt->context;
+    oldnode = xpctxt->node;
+    olddoc = xpctxt->doc;
+    oldcs = xpctxt->contextSize;
+    oldpp = xpctxt->proximityPosition;
+    filterOp = &ctxt->comp->steps[filterOpIndex];
+
+    xpctxt->contextSize = set->nodeNr;
+
+    /*
+     * "[position() = last()]" only matches the last node.
+     */
+    if (filterOp->fast == XPATH_FAST_LAST) {
+        if (minPos > 1) {
+            xmlXPathNodeSetClear(set, hasNsNodes);
+        } else {
+            xmlXPathNodeSetKeepLast(set);
+        }
+        j = set->nodeNr;
+        goto done;
+    }
+
+#ifdef XPATH_PARALLEL
+    /*
+     * Non-positional predicates over large sets can be evaluated in
+     * parallel, then the set is compacted in order.
+     */
+    if ((xpctxt->parallelThreads > 1) &&
+        (minPos == 1) && (maxPos >= set->nodeNr) && (!hasNsNodes) &&
+        (set->nodeNr >= xpctxt->parallelMinNodes)) {
+        char *keep;
+
+        keep = xmlXPathNodeSetFilterParallel(ctxt, set, filterOp);
+        if (keep != NULL) {
+            for (i = 0, j = 0; i < set->nodeNr; i++) {
+                if (keep[i])
+                    set->nodeTab[j++] = set->nodeTab[i];
+            }
+            for (i = j; i < set->nodeNr; i++)
+                set->nodeTab[i] = NULL;
+            xmlFree(keep);
+            goto done;
+        }
+    }
+#endif
+
+    for (i = 0, j = 0, pos = 1; i < set->nodeNr; i++) {
+        xmlNodePtr node = set->nodeTab[i];
+        int res;
+
+        xpctxt->node = node;
+        xpctxt->proximityPosition = i + 1;
+
+        /*
+        * Also set the xpath document in case things like
+        * key() are evaluated in the predicate.
+        *
+        * TODO: Get real doc for namespace nodes.
+        */
+        if ((node->type != XML_NAMESPACE_DECL) &&
+            (node->doc != NULL))
+            xpctxt->doc = node->doc;
+
+        res = xmlXPathCompOpEvalToBoolean(ctxt, filterOp, 1);
+
+        if (ctxt->error != XPATH_EXPRESSION_OK)
+            break;
+        if (res < 0) {
+            /* Shouldn't happen */
+            xmlXPathErr(ctxt, XPATH_EXPR_ERROR);
+            break;
+        }
+
+        if ((res != 0) && ((pos >= minPos) && (pos <= maxPos))) {
+            if (i != j) {
+                set->nodeTab[j] = node;
+                set->nodeTab[i] = NULL;
+            }
+
+            j += 1;
+        } else {
+            /* Remove the entry from the initial node set. */
+            set->nodeTab[i] = NULL;
+            if (node->type == XML_NAMESPACE_DECL)
+                xmlXPathNodeSetFreeNs((xmlNsPtr) node);
+        }
+
+        if (res != 0) {
+            if (pos == maxPos) {
+                i += 1;
+                break;
+            }
+
+            pos += 1;
+        }
+    }
+
+    /* Free remaining nodes. */
+    if (hasNsNodes) {
+        for (; i < set->nodeNr; i++) {
+            xmlNodePtr node = set->nodeTab[i];
+            if ((node != NULL) && (node->type == XML_NAMESPACE_DECL))
+                xmlXPathNodeSetFreeNs((xmlNsPtr) node);
+        }
+    }
+
+done:
+    set->nodeNr = j;
+
+    /* If too many elements were removed, shrink table to preserve memory. */
+    if ((set->nodeMax > XML_NODESET_DEFAULT) &&
+        (set->nodeNr < set->nodeMax / 2)) {
+        xmlNodePtr *tmp;
+        int nodeMax = set->nodeNr;
+
+        if (nodeMax < XML_NODESET_DEFAULT)
+            nodeMax = XML_NODESET_DEFAULT;
+        tmp = (xmlNodePtr *) xmlRealloc(set->nodeTab,
+                nodeMax * sizeof(xmlNodePtr));
+        if (tmp == NULL) {
+            xmlXPathPErrMemory(ctxt);
+        } else {
+            set->nodeTab = tmp;
+            set->nodeMax = nodeMax;
+        }
+    }
+
+    xpctxt->node = oldnode;
+    xpctxt->doc = olddoc;
+    xpctxt->contextSize = oldcs;
+    xpctxt->proximityPosition = oldpp;
+}
+
+/**
+ * Filter a node set, keeping only nodes for which the sequence of predicate
+ * expressions matches. Afterwards, keep only nodes between minPos and maxPos
+ * in the filtered result.
+ *
+ * @param ctxt  the XPath Parser context
+ * @param op  the predicate op
+ * @param set  the node set to filter
+ * @param minPos  minimum position in the filtered set (1-based)
+ * @param maxPos  maximum position in the filtered set (1-based)
+ * @param hasNsNodes  true if the node set may contain namespace nodes
+ */
+static void
+xmlXPathCompOpEvalPredicate(xmlXPathParserContextPtr ctxt,
+			    xmlXPathStepOpPtr op,
+			    xmlNodeSetPtr set,
+                            int minPos, int maxPos,
+			    int hasNsNodes)
+{
+    if (op->ch1 != -1) {
+	xmlXPathCompExprPtr comp = ctxt->comp;
+	/*
+	* Process inner predicates first.
+	*/
+	if (comp->steps[op->ch1].op != XPATH_OP_PREDICATE) {
+            XP_ERROR(XPATH_INVALID_OPERAND);
+	}
+        if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
+            XP_ERROR(XPATH_RECURSION_LIMIT_EXCEEDED);
+        ctxt->context->depth += 1;
+	xmlXPathCompOpEvalPredicate(ctxt, &comp->steps[op->ch1], set,
+                                    1, set->nodeNr, hasNsNodes);
+        ctxt->context->depth -= 1;
+	CHECK_ERROR;
+    }
+
+    if (op->ch2 != -1)
+        xmlXPathNodeSetFilter(ctxt, set, op->ch2, minPos, maxPos, hasNsNodes);
+}
+
+static int
+xmlXPathIsPositionalPredicate(xmlXPathParserContextPtr ctxt,
+			    xmlXPathStepOpPtr op,
+			    int *maxPos)
+{
+
+    xmlXPathStepOpPtr exprOp;
+
+    /*
+    * BIG NOTE: This is not intended for XPATH_OP_FILTER yet!
+    */
+
+    /*
+    * If not -1, then ch1 will point to:
+    * 1) For predicates (XPATH_OP_PREDICATE):
+    *    - an inner predicate operator
+    * 2) For filters (XPATH_OP_FILTER):
+    *    - an inner filter operator OR
+    *    - an expression selecting the node set.
+    *      E.g. "key('a', 'b')" or "(//foo | //bar)".
+    */
+    if ((op->op != XPATH_OP_PREDICATE) && (op->op != XPATH_OP_FILTER))
+	return(0);
+
+    if (op->ch2 != -1) {
+	exprOp = &ctxt->comp->steps[op->ch2];
+    } else
+	return(0);
+
+    if ((exprOp != NULL) &&
+	(exprOp->op == XPATH_OP_VALUE) &&
+	(exprOp->value4 != NULL) &&
+	(((xmlXPathObjectPtr) exprOp->value4)->type == XPATH_NUMBER))
+    {
+        double floatval = ((xmlXPathObjectPtr) exprOp->value4)->floatval;
+
+	/*
+	* We have a "[n]" predicate here.
+	* TODO: Unfortunately this simplistic test here is not
+	* able to detect a position() predicate in compound
+	* expressions like "[@attr = 'a" and position() = 1],
+	* and even not the usage of position() in
+	* "[position() = 1]"; thus - obviously - a position-range,
+	* like it "[position() < 5]", is also not detected.
+	* Maybe we could rewrite the AST to ease the optimization.
+	*/
+
+        if ((floatval > INT_MIN) && (floatval < INT_MAX)) {
+	    *maxPos = (int) floatval;
+            if (floatval == (double) *maxPos)
+                return(1);
+        }
+    }
+    return(0);
+}
+
+/*
+ * Check whether a predicate is a single "[@name = value]" test where
+ * value is a string literal or a variable. Such a predicate doesn't
+ * depend on the context position and can be answered from the
+ * attribute values in the name index of a document.
+ */
+static int
+xmlXPathIsAttrValuePredicate(xmlXPathCompExprPtr comp,
+                             xmlXPathStepOpPtr op)
+{
+    xmlXPathStepOpPtr exprOp, attrOp, valueOp;
+    int i;
+
+    if ((op->op != XPATH_OP_PREDICATE) || (op->ch1 != -1) || (op->ch2 == -1))
+        return(0);
+    exprOp = &comp->steps[op->ch2];
+    if ((exprOp->op != XPATH_OP_EQUAL) || (exprOp->value != 1))
+        return(0);
+
+    for (i = 0; i < 2; i++) {
+        attrOp = &comp->steps[i == 0 ? exprOp->ch1 : exprOp->ch2];
+        valueOp = &comp->steps[i == 0 ? exprOp->ch2 : exprOp->ch1];
+
+        if ((attrOp->op != XPATH_OP_COLLECT) ||
+            ((xmlXPathAxisVal) attrOp->value != AXIS_ATTRIBUTE) ||
+            ((xmlXPathTestVal) attrOp->value2 != NODE_TEST_NAME) ||
+            (attrOp->ch2 != -1) || (attrOp->ch1 == -1) ||
+            (comp->steps[attrOp->ch1].op != XPATH_OP_NODE))
+            continue;
+
+        if (((valueOp->op == XPATH_OP_VALUE) &&
+             (((xmlXPathObjectPtr) valueOp->value4)->type == XPATH_STRING)) ||
+            ((valueOp->op == XPATH_OP_VARIABLE) && (valueOp->ch1 == -1)))
+            return(i == 0 ? 1 : 2);
+    }
+
+    return(0);
+}
+
+/*
+ * Resolve the attribute name and the value of a predicate matched
+ * by xmlXPathIsAttrValuePredicate. Returns a string object which
+ * must be released or NULL if the value isn't a string or a name
+ * can't be resolved. Errors are left to the regular evaluation.
+ */
+static xmlXPathObjectPtr
+xmlXPathGetAttrValueTest(xmlXPathParserContextPtr ctxt,
+                         xmlXPathStepOpPtr op, const xmlChar **attrName,
+                         const xmlChar **attrURI)
+{
+    xmlXPathCompExprPtr comp = ctxt->comp;
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    xmlXPathStepOpPtr exprOp, attrOp, valueOp;
+    xmlXPathObjectPtr value;
+    int which;
+
+    which = xmlXPathIsAttrValuePredicate(comp, op);
+    if (which == 0)
+        return(NULL);
+    exprOp = &comp->steps[op->ch2];
+    attrOp = &comp->steps[which == 1 ? exprOp->ch1 : exprOp->ch2];
+    valueOp = &comp->steps[which == 1 ? exprOp->ch2 : exprOp->ch1];
+
+    *attrName = attrOp->value5;
+    *attrURI = NULL;
+    if (attrOp->value4 != NULL) {
+        *attrURI = xmlXPathNsLookup(xpctxt, attrOp->value4);
+        if (*attrURI == NULL)
+            return(NULL);
+    }
+
+    if (valueOp->op == XPATH_OP_VALUE) {
+        value = xmlXPathCacheObjectCopy(ctxt, valueOp->value4);
+    } else if (valueOp->value5 == NULL) {
+        value = xmlXPathVariableLookup(xpctxt, valueOp->value4);
+    } else {
+        const xmlChar *URI = xmlXPathNsLookup(xpctxt, valueOp->value5);
+
+        if (URI == NULL)
+            return(NULL);
+        value = xmlXPathVariableLookupNS(xpctxt, valueOp->value4, URI);
+    }
+    if ((value != NULL) &&
+        ((value->type != XPATH_STRING) || (value->stringval == NULL))) {
+        xmlXPathReleaseObject(xpctxt, value);
+        value = NULL;
+    }
+
+    return(value);
+}
+
+/*
+ * Names in the document and the compiled expression are usually
+ * interned in the same dictionary.
+ */
+#define XP_FAST_NAME_EQUAL(a, b) \
+    (((a) == (b)) || (((a)[0] == (b)[0]) && (xmlStrEqual((a), (b)))))
+
+/*
+ * Namespace URI of a name test. The IDs are looked up once per step,
+ * while the tree isn't modified.
+ */
+typedef struct {
+    const xmlChar *URI;
+    int uriId;                  /* ID of URI, 0 if unknown */
+    xmlNsIdCache nsIds;         /* ID of the last namespace tested */
+} xmlXPathNsTest;
+
+static void
+xmlXPathNsTestInit(xmlXPathNsTest *test, xmlXPathContextPtr xpctxt,
+                   const xmlChar *URI) {
+    xmlDictPtr dict = (xpctxt->doc != NULL) ? xpctxt->doc->dict : NULL;
+
+    test->URI = URI;
+    test->uriId = (URI != NULL) ? xmlDictNsId(dict, URI, 0) : 0;
+    xmlNsIdCacheInit(&test->nsIds, dict);
+}
+
+/*
+ * Check whether a namespace has the URI of a name test, comparing
+ * IDs if possible.
+ */
+static XML_INLINE int
+xmlXPathNsMatch(xmlXPathNsTest *test, const xmlNs *ns) {
+    int res;
+
+    if (ns == NULL)
+        return(0);
+    res = xmlNsIdCompare(test->uriId, xmlNsIdCacheGet(&test->nsIds, ns));
+    if (res >= 0)
+        return(res);
+    return(xmlStrEqual(test->URI, ns->href));
+}
+
+/**
+ * Evaluate a location step tagged by xmlXPathOptimizeExpression with
+ * a loop specialized for its axis and node test. The node-set with
+ * the context nodes on the stack is replaced with the result.
+ *
+ * Steps which might not produce the same result as the generic
+ * evaluator are left alone: descendant steps on documents with a
+ * name index and descendant steps that would enter entity references.
+ *
+ * @param ctxt  the XPath Parser context
+ * @param op  the COLLECT operation
+ * @param toBool  stop after the first match
+ * @returns the number of traversed nodes or -1 if the step must
+ * be evaluated by xmlXPathNodeCollectAndTest.
+ */
+static int
+xmlXPathNodeCollectFast(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op,
+                        int toBool)
+{
+    xmlXPathContextPtr xpctxt = ctxt->context;
+    const xmlChar *prefix = op->value4;
+    const xmlChar *name = op->value5;
+    const xmlChar *URI = NULL;
+    xmlXPathObjectPtr obj = ctxt->value;
+    xmlNodeSetPtr contextSeq, outSeq = NULL, seq = NULL;
+    xmlXPathNodeSetMergeFunction mergeAndClear;
+    xmlNodePtr contextNode, cur;
+    int i, total = 0;
+    xmlXPathNsTest nsTest;
+
+    if ((obj == NULL) || (obj->type != XPATH_NODESET) ||
+        ((obj->boolval) && (obj->user != NULL)))
+        return(-1);
+    contextSeq = obj->nodesetval;
+    if ((contextSeq == NULL) || (contextSeq->nodeNr <= 0))
+        return(-1);
+    if (prefix != NULL) {
+        URI = xmlXPathNsLookup(xpctxt, prefix);
+        if (URI == NULL)
+            return(-1);
+    }
+    xmlXPathNsTestInit(&nsTest, xpctxt, URI);
+
+    if (op->fast == XPATH_FAST_DESCENDANT_NAME) {
+        for (i = 0; i < contextSeq->nodeNr; i++) {
+            contextNode = contextSeq->nodeTab[i];
+            if ((contextNode->type == XML_ATTRIBUTE_NODE) ||
+                (contextNode->type == XML_NAMESPACE_DECL))
+                continue;
+            if ((contextNode->type != XML_ELEMENT_NODE) &&
+                (contextNode->type != XML_DOCUMENT_NODE) &&
+                (contextNode->type != XML_HTML_DOCUMENT_NODE) &&
+                (contextNode->type != XML_DOCUMENT_FRAG_NODE))
+                return(-1);
+            if ((contextNode->doc != NULL) &&
+                (contextNode->doc->nameIndex != NULL))
+                return(-1);
+        }
+        mergeAndClear = xmlXPathNodeSetMergeAndClear;
+    } else {
+        mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
+    }
+
+    for (i = 0; i < contextSeq->nodeNr; i++) {
+        contextNode = contextSeq->nodeTab[i];
+
+        if (seq == NULL) {
+            seq = xmlXPathNodeSetCreate(NULL);
+            if (seq == NULL) {
+                xmlXPathPErrMemory(ctxt);
+                break;
+            }
+        }
+
+        switch (op->fast) {
+            case XPATH_FAST_CHILD_NAME:
+                switch (contextNode->type) {
+                    case XML_ELEMENT_NODE:
+                    case XML_DOCUMENT_NODE:
+                    case XML_HTML_DOCUMENT_NODE:
+                    case XML_DOCUMENT_FRAG_NODE:
+                    case XML_ENTITY_REF_NODE:
+                    case XML_ENTITY_NODE:
+                        break;
+                    default:
+                        continue;
+                }
+                for (cur = contextNode->children; cur != NULL;
+                     cur = cur->next) {
+                    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+                        goto error;
+                    total++;
+                    if ((cur->type != XML_ELEMENT_NODE) ||
+                        (!XP_FAST_NAME_EQUAL(cur->name, name)))
+                        continue;
+                    if (prefix == NULL) {
+                        if (cur->ns != NULL)
+                            continue;
+                    } else if (!xmlXPathNsMatch(&nsTest, cur->ns)) {
+                        continue;
+                    }
+                    if (xmlXPathNodeSetAddUnique(seq, cur) < 0)
+                        xmlXPathPErrMemory(ctxt);
+                    if (toBool)
+                        break;
+                }
+                break;
+
+            case XPATH_FAST_ATTRIBUTE_NAME: {
+                xmlAttrPtr attr;
+
+                if (contextNode->type != XML_ELEMENT_NODE)
+                    continue;
+                for (attr = contextNode->properties; attr != NULL;
+                     attr = attr->next) {
+                    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+                        goto error;
+                    total++;
+                    if (!XP_FAST_NAME_EQUAL(attr->name, name))
+                        continue;
+                    if (prefix == NULL) {
+                        if ((attr->ns != NULL) && (attr->ns->prefix != NULL))
+                            continue;
+                    } else if (!xmlXPathNsMatch(&nsTest, attr->ns)) {
+                        continue;
+                    }
+                    if (xmlXPathNodeSetAddUnique(seq, (xmlNodePtr) attr) < 0)
+                        xmlXPathPErrMemory(ctxt);
+                    if (toBool)
+                        break;
+                }
+                break;
+            }
+
+            case XPATH_FAST_DESCENDANT_NAME:
+                if ((contextNode->type == XML_ATTRIBUTE_NODE) ||
+                    (contextNode->type == XML_NAMESPACE_DECL))
+                    continue;
+                cur = contextNode->children;
+                while (cur != NULL) {
+                    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+                        goto error;
+                    total++;
+                    if (cur->type == XML_ELEMENT_NODE) {
+                        if ((XP_FAST_NAME_EQUAL(cur->name, name)) &&
+                            ((prefix == NULL) ?
+                             (cur->ns == NULL) :
+                             (xmlXPathNsMatch(&nsTest, cur->ns)))) {
+                            if (xmlXPathNodeSetAddUnique(seq, cur) < 0)
+                                xmlXPathPErrMemory(ctxt);
+                            if (toBool)
+                                break;
+                        }
+                        if (cur->children != NULL) {
+                            cur = cur->children;
+                            continue;
+                        }
+                    } else if ((cur->type == XML_ENTITY_REF_NODE) &&
+                               (cur->children != NULL)) {
+                        xmlXPathFreeNodeSet(seq);
+                        xmlXPathFreeNodeSet(outSeq);
+                        return(-1);
+                    }
+                    while (cur->next == NULL) {
+                        cur = cur->parent;
+                        if ((cur == NULL) || (cur == contextNode))
+                            break;
+                    }
+                    if ((cur == NULL) || (cur == contextNode))
+                        break;
+                    cur = cur->next;
+                }
+                break;
+
+            case XPATH_FAST_CHILD_TEXT:
+                switch (contextNode->type) {
+                    case XML_ATTRIBUTE_NODE:
+                    case XML_NAMESPACE_DECL:
+                    case XML_ELEMENT_DECL:
+                    case XML_ATTRIBUTE_DECL:
+                    case XML_ENTITY_DECL:
+                    case XML_XINCLUDE_START:
+                    case XML_XINCLUDE_END:
+                        continue;
+                    default:
+                        break;
+                }
+                for (cur = contextNode->children; cur != NULL;
+                     cur = cur->next) {
+                    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+                        goto error;
+                    total++;
+                    if ((cur->type != XML_TEXT_NODE) &&
+                        (cur->type != XML_CDATA_SECTION_NODE))
+                        continue;
+                    if (xmlXPathNodeSetAddUnique(seq, cur) < 0)
+                        xmlXPathPErrMemory(ctxt);
+                    if (toBool)
+                        break;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        if (seq->nodeNr > 0) {
+            if (outSeq == NULL) {
+                outSeq = seq;
+                seq = NULL;
+            } else {
+                outSeq = mergeAndClear(outSeq, seq);
+                if (outSeq == NULL)
+                    xmlXPathPErrMemory(ctxt);
+            }
+            if (toBool)
+                break;
+        }
+    }
+
+error:
+    if (outSeq == NULL) {
+        outSeq = seq;
+        seq = NULL;
+        if (outSeq == NULL) {
+            outSeq = xmlXPathNodeSetCreate(NULL);
+            if (outSeq == NULL)
+                xmlXPathPErrMemory(ctxt);
+        }
+    }
+    xmlXPathFreeNodeSet(seq);
+    xmlXPathReleaseObject(xpctxt, xmlXPathValuePop(ctxt));
+    xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, outSeq));
+
+    return(total);
+}
+
+/*
+ * Node test for a node picked from the child index, see
+ * xmlXPathNodeCollectAndTest. Only element children and the
+ * node() type test are supported.
+ */
+static int
+xmlXPathIndexedChildMatch(xmlXPathTestVal test, const xmlChar *prefix,
+                          const xmlChar *name, const xmlChar *URI,
+                          xmlNodePtr cur) {
+    if (test == NODE_TEST_TYPE)
+        return(1);
+    if ((test == NODE_TEST_NAME) && (!xmlStrEqual(name, cur->name)))
+        return(0);
+    if (prefix == NULL)
+        return((test == NODE_TEST_ALL) || (cur->ns == NULL));
+    return((cur->ns != NULL) && (xmlStrEqual(URI, cur->ns->href)));
+}
+
+static int
+xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
+                           xmlXPathStepOpPtr op,
+			   xmlNodePtr * first, xmlNodePtr * last,
+			   int toBool)
+{
+
+#define XP_TEST_HIT \
+    if (hasAxisRange != 0) { \
+	if (++pos == maxPos) { \
+	    if (addNode(seq, cur) < 0) \
+	        xmlXPathPErrMemory(ctxt); \
+	    goto axis_range_end; } \
+    } else { \
+	if (addNode(seq, cur) < 0) \
+	    xmlXPathPErrMemory(ctxt); \
+	if (breakOnFirstHit) goto first_hit; }
+
+#define XP_TEST_HIT_NS \
+    if (hasAxisRange != 0) { \
+	if (++pos == maxPos) { \
+	    hasNsNodes = 1; \
+	    if (xmlXPathNodeSetAddNs(seq, xpctxt->node, (xmlNsPtr) cur) < 0) \
+	        xmlXPathPErrMemory(ctxt); \
+	goto axis_range_end; } \
+    } else { \
+	hasNsNodes = 1; \
+	if (xmlXPathNodeSetAddNs(seq, xpctxt->node, (xmlNsPtr) cur) < 0) \
+	    xmlXPathPErrMemory(ctxt); \
+	if (breakOnFirstHit) goto first_hit; }
+
+    xmlXPathAxisVal axis = (xmlXPathAxisVal) op->value;
+    xmlXPathTestVal test = (xmlXPathTestVal) op->value2;
+    xmlXPathTypeVal type = (xmlXPathTypeVal) op->value3;
+    const xmlChar *prefix = op->value4;
+    const xmlChar *name = op->value5;
+    const xmlChar *URI = NULL;
+
+    int total = 0, hasNsNodes = 0;
+    /* The popped object holding the context nodes */
+    xmlXPathObjectPtr obj;
+    /* The set of context nodes for the node tests */
+    xmlNodeSetPtr contextSeq;
+    int contextIdx;
+    xmlNodePtr contextNode;
+    /* The final resulting node set wrt to all context nodes */
+    xmlNodeSetPtr outSeq;
+    /*
+    * The temporary resulting node set wrt 1 context node.
+    * Used to feed predicate evaluation.
+    */
+    xmlNodeSetPtr seq;
+    xmlNodePtr cur;
+    /* First predicate operator */
+    xmlXPathStepOpPtr predOp;
+    int maxPos; /* The requested position() (when a "[n]" predicate) */
+    int hasPredicateRange, hasAxisRange, pos;
+    int breakOnFirstHit, useIndex, indexed;
+    /* Positional child steps using the child index */
+    int useChildIndex, childElems, lastOnly;
+    /* String value of a "[@name = value]" predicate */
+    xmlXPathObjectPtr valueObj = NULL;
+    const xmlChar *attrName = NULL, *attrURI = NULL;
+    xmlXPathNsTest nsTest;
+
+    xmlXPathTraversalFunction next = NULL;
+    int (*addNode) (xmlNodeSetPtr, xmlNodePtr);
+    xmlXPathNodeSetMergeFunction mergeAndClear;
+    xmlNodePtr oldContextNode;
+    xmlXPathContextPtr xpctxt = ctxt->context;
+
+    /*
+    * When searching for the last node of a step without predicates
+    * (see xmlXPathCompOpEvalLast), only the last matching child of
+    * each context node is needed which the child index provides.
+    */
+    lastOnly = ((last != NULL) && (axis == AXIS_CHILD) &&
+                (op->ch2 == -1) && (xpctxt->doc != NULL) &&
+                (xpctxt->doc->nameIndex != NULL));
+
+    if ((op->fast != XPATH_FAST_NONE) && (!lastOnly) &&
+        ((first == NULL) || (*first == NULL)) &&
+        ((last == NULL) || (*last == NULL))) {
+        total = xmlXPathNodeCollectFast(ctxt, op, toBool);
+        if (total >= 0) {
+            if (ctxt->profile != NULL)
+                ((xmlXPathOpProfile *) ctxt->profile)
+                    [op - ctxt->comp->steps].visited += total;
+            return(total);
+        }
+        total = 0;
+    }
+
+    CHECK_TYPE0(XPATH_NODESET);
+    obj = xmlXPathValuePop(ctxt);
+    /*
+    * Setup namespaces.
+    */
+    if (prefix != NULL) {
+        URI = xmlXPathNsLookup(xpctxt, prefix);
+        if (URI == NULL) {
+	    xmlXPathReleaseObject(xpctxt, obj);
+            xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
+                           "Undefined namespace prefix: %s\n", prefix);
+            return 0;
+	}
+    }
+    xmlXPathNsTestInit(&nsTest, xpctxt, URI);
+    /*
+    * Setup axis.
+    *
+    * MAYBE FUTURE TODO: merging optimizations:
+    * - If the nodes to be traversed wrt to the initial nodes and
+    *   the current axis cannot overlap, then we could avoid searching
+    *   for duplicates during the merge.
+    *   But the question is how/when to evaluate if they cannot overlap.
+    *   Example: if we know that for two initial nodes, the one is
+    *   not in the ancestor-or-self axis of the other, then we could safely
+    *   avoid a duplicate-aware merge, if the axis to be traversed is e.g.
+    *   the descendant-or-self axis.
+    */
+    mergeAndClear = xmlXPathNodeSetMergeAndClear;
+    switch (axis) {
+        case AXIS_ANCESTOR:
+            first = NULL;
+            next = xmlXPathNextAncestor;
+            break;
+        case AXIS_ANCESTOR_OR_SELF:
+            first = NULL;
+            next = xmlXPathNextAncestorOrSelf;
+            break;
+        case AXIS_ATTRIBUTE:
+            first = NULL;
+	    last = NULL;
+            next = xmlXPathNextAttribute;
+	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
+            break;
+        case AXIS_CHILD:
+	    last = NULL;
+	    if (((test == NODE_TEST_NAME) || (test == NODE_TEST_ALL)) &&
+		(type == NODE_TYPE_NODE))
+	    {
+		/*
+		* Optimization if an element node type is 'element'.
+		*/
+		next = xmlXPathNextChildElement;
+	    } else
+		next = xmlXPathNextChild;
+	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
+            break;
+        case AXIS_DESCENDANT:
+	    last = NULL;
+            next = xmlXPathNextDescendant;
+            break;
+        case AXIS_DESCENDANT_OR_SELF:
+	    last = NULL;
+            next = xmlXPathNextDescendantOrSelf;
+            break;
+        case AXIS_FOLLOWING:
+	    last = NULL;
+            next = xmlXPathNextFollowing;
+            break;
+        case AXIS_FOLLOWING_SIBLING:
+	    last = NULL;
+            next = xmlXPathNextFollowingSibling;
+            break;
+        case AXIS_NAMESPACE:
+            first = NULL;
+	    last = NULL;
+            next = (xmlXPathTraversalFunction) xmlXPathNextNamespace;
+	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
+            break;
+        case AXIS_PARENT:
+            first = NULL;
+            next = xmlXPathNextParent;
+            break;
+        case AXIS_PRECEDING:
+            first = NULL;
+            next = xmlXPathNextPrecedingInternal;
+            break;
+        case AXIS_PRECEDING_SIBLING:
+            first = NULL;
+            next = xmlXPathNextPrecedingSibling;
+            break;
+        case AXIS_SELF:
+            first = NULL;
+	    last = NULL;
+            next = xmlXPathNextSelf;
+	    mergeAndClear = xmlXPathNodeSetMergeAndClearNoDupls;
+            break;
+    }
+
+    if (next == NULL) {
+	xmlXPathReleaseObject(xpctxt, obj);
+        return(0);
+    }
+    contextSeq = obj->nodesetval;
+    if ((contextSeq == NULL) || (contextSeq->nodeNr <= 0)) {
+        xmlXPathValuePush(ctxt, obj);
+        return(0);
+    }
+    /*
+    * Predicate optimization ---------------------------------------------
+    * If this step has a last predicate, which contains a position(),
+    * then we'll optimize (although not exactly "position()", but only
+    * the  short-hand form, i.e., "[n]".
+    *
+    * Example - expression "/foo[parent::bar][1]":
+    *
+    * COLLECT 'child' 'name' 'node' foo    -- op (we are here)
+    *   ROOT                               -- op->ch1
+    *   PREDICATE                          -- op->ch2 (predOp)
+    *     PREDICATE                          -- predOp->ch1 = [parent::bar]
+    *       SORT
+    *         COLLECT  'parent' 'name' 'node' bar
+    *           NODE
+    *     ELEM Object is a number : 1        -- predOp->ch2 = [1]
+    *
+    */
+    maxPos = 0;
+    predOp = NULL;
+    hasPredicateRange = 0;
+    hasAxisRange = 0;
+    if (op->ch2 != -1) {
+	/*
+	* There's at least one predicate. 16 == XPATH_OP_PREDICATE
+	*/
+	predOp = &ctxt->comp->steps[op->ch2];
+	if (xmlXPathIsPositionalPredicate(ctxt, predOp, &maxPos)) {
+	    if (predOp->ch1 != -1) {
+		/*
+		* Use the next inner predicate operator.
+		*/
+		predOp = &ctxt->comp->steps[predOp->ch1];
+		hasPredicateRange = 1;
+	    } else {
+		/*
+		* There's no other predicate than the [n] predicate.
+		*/
+		predOp = NULL;
+		hasAxisRange = 1;
+	    }
+	}
+    }
+    breakOnFirstHit = ((toBool) && (predOp == NULL)) ? 1 : 0;
+    /*
+    * Name tests on the descendant axes can use the element name index
+    * of the document (see xmlDocSetNameIndex).
+    */
+    useIndex = (((axis == AXIS_DESCENDANT) ||
+                 (axis == AXIS_DESCENDANT_OR_SELF) ||
+                 (axis == AXIS_CHILD)) &&
+                (test == NODE_TEST_NAME) &&
+                ((first == NULL) || (*first == NULL)));
+    /*
+    * A single "[@name = value]" predicate can be answered by the
+    * attribute value tables of the index. The child axis only uses
+    * the index in this case.
+    */
+    if ((useIndex) && (predOp != NULL) && (hasPredicateRange == 0))
+        valueObj = xmlXPathGetAttrValueTest(ctxt, predOp, &attrName,
+                                            &attrURI);
+    if ((axis == AXIS_CHILD) && (valueObj == NULL))
+        useIndex = 0;
+    /*
+    * Child steps with a single "[n]" predicate and a large n pick
+    * the node directly from the child index. Name tests can only
+    * be answered if all element children have the same name.
+    */
+    useChildIndex = 0;
+    childElems = 0;
+    if ((axis == AXIS_CHILD) &&
+        ((lastOnly) ||
+         ((hasAxisRange) && (maxPos >= XML_CHILD_INDEX_MIN))) &&
+        ((first == NULL) || (*first == NULL))) {
+        if ((test == NODE_TEST_NAME) || (test == NODE_TEST_ALL)) {
+            useChildIndex = 1;
+            childElems = 1;
+        } else if ((test == NODE_TEST_TYPE) && (type == NODE_TYPE_NODE)) {
+            useChildIndex = 1;
+        }
+    }
+    /*
+    * Axis traversal -----------------------------------------------------
+    */
+    /*
+     * 2.3 Node Tests
+     *  - For the attribute axis, the principal node type is attribute.
+     *  - For the namespace axis, the principal node type is namespace.
+     *  - For other axes, the principal node type is element.
+     *
+     * A node test * is true for any node of the
+     * principal node type. For example, child::* will
+     * select all element children of the context node
+     */
+    oldContextNode = xpctxt->node;
+    addNode = xmlXPathNodeSetAddUnique;
+    outSeq = NULL;
+    seq = NULL;
+    contextNode = NULL;
+    contextIdx = 0;
+
+
+    while (((contextIdx < contextSeq->nodeNr) || (contextNode != NULL)) &&
+           (ctxt->error == XPATH_EXPRESSION_OK)) {
+	xpctxt->node = contextSeq->nodeTab[contextIdx++];
+
+	if (seq == NULL) {
+	    seq = xmlXPathNodeSetCreate(NULL);
+	    if (seq == NULL) {
+                xmlXPathPErrMemory(ctxt);
+		total = 0;
+		goto error;
+	    }
+	}
+	/*
+	* Traverse the axis and test the nodes.
+	*/
+	pos = 0;
+	cur = NULL;
+	hasNsNodes = 0;
+        indexed = 0;
+
+        if (useChildIndex) {
+            xmlNodePtr *list;
+            int nbList, flags, i, usable;
+
+            if (xmlDocIndexChildren(xpctxt->node, childElems, &list,
+                                    &nbList, &flags) == 0) {
+                if (!childElems)
+                    usable = flags & XML_CHILD_INDEX_PLAIN;
+                else if ((test == NODE_TEST_ALL) && (prefix == NULL))
+                    usable = 1;
+                else
+                    usable = flags & XML_CHILD_INDEX_UNIFORM;
+            } else {
+                usable = 0;
+            }
+
+            if (usable) {
+                i = lastOnly ? nbList - 1 : maxPos - 1;
+                if ((i >= 0) && (i < nbList)) {
+                    cur = list[i];
+                    total++;
+                    if (xmlXPathIndexedChildMatch(test, prefix, name, URI,
+                                                  cur)) {
+                        pos = maxPos - 1;
+                        XP_TEST_HIT
+                    }
+                }
+                goto apply_predicates;
+            }
+        }
+
+        if (useIndex) {
+            xmlNodePtr *list;
+            int nbList, i, res;
+
+            if (valueObj != NULL)
+                res = xmlDocIndexLookupValue(xpctxt->node, name, URI,
+                                             attrName, attrURI,
+                                             valueObj->stringval,
+                                             axis == AXIS_DESCENDANT_OR_SELF,
+                                             &list, &nbList);
+            else
+                res = xmlDocIndexLookup(xpctxt->node, name, URI,
+                                        axis == AXIS_DESCENDANT_OR_SELF,
+                                        &list, &nbList);
+            if (res == 0) {
+                for (i = 0; i < nbList; i++) {
+                    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+                        goto error;
+
+                    cur = list[i];
+                    if ((axis == AXIS_CHILD) && (cur->parent != xpctxt->node))
+                        continue;
+                    total++;
+                    XP_TEST_HIT
+                }
+                indexed = (valueObj != NULL);
+                goto apply_predicates;
+            }
+        }
+
+        do {
+            if (OP_LIMIT_EXCEEDED(ctxt, 1))
+                goto error;
+
+            cur = next(ctxt, cur);
+            if (cur == NULL)
+                break;
+
+	    /*
+	    * QUESTION TODO: What does the "first" and "last" stuff do?
+	    */
+            if ((first != NULL) && (*first != NULL)) {
+		if (*first == cur)
+		    break;
+		if (((total % 256) == 0) &&
+#ifdef XP_OPTIMIZED_NON_ELEM_COMPARISON
+		    (xmlXPathCmpNodesExt(*first, cur) >= 0))
+#else
+		    (xmlXPathCmpNodes(*first, cur) >= 0))
+#endif
+		{
+		    break;
+		}
+	    }
+	    if ((last != NULL) && (*last != NULL)) {
+		if (*last == cur)
+		    break;
+		if (((total % 256) == 0) &&
+#ifdef XP_OPTIMIZED_NON_ELEM_COMPARISON
+		    (xmlXPathCmpNodesExt(cur, *last) >= 0))
+#else
+		    (xmlXPathCmpNodes(cur, *last) >= 0))
+#endif
+		{
+		    break;
+		}
+	    }
+
+            total++;
+
+	    switch (test) {
+                case NODE_TEST_NONE:
+		    total = 0;
+		    goto error;
+                case NODE_TEST_TYPE:
+		    if (type == NODE_TYPE_NODE) {
+			switch (cur->type) {
+			    case XML_DOCUMENT_NODE:
+			    case XML_HTML_DOCUMENT_NODE:
+			    case XML_ELEMENT_NODE:
+			    case XML_ATTRIBUTE_NODE:
+			    case XML_PI_NODE:
+			    case XML_COMMENT_NODE:
+			    case XML_CDATA_SECTION_NODE:
+			    case XML_TEXT_NODE:
+				XP_TEST_HIT
+				break;
+			    case XML_NAMESPACE_DECL: {
+				if (axis == AXIS_NAMESPACE) {
+				    XP_TEST_HIT_NS
+				} else {
+	                            hasNsNodes = 1;
+				    XP_TEST_HIT
+				}
+				break;
+                            }
+			    default:
+				break;
+			}
+		    } else if (cur->type == (xmlElementType) type) {
+			if (cur->type == XML_NAMESPACE_DECL)
+			    XP_TEST_HIT_NS
+			else
+			    XP_TEST_HIT
+		    } else if ((type == NODE_TYPE_TEXT) &&
 			 (cur->type == XML_CDATA_SECTION_NODE))
 		    {
 			XP_TEST_HIT
@@ -10095,1867 +12513,3524 @@ xmlXPathNodeCollectAndTest(xmlXPathParserContextPtr ctxt,
 		    {
 			XP_TEST_HIT
                     }
-                    break;
-                case NODE_TEST_ALL:
-                    if (axis == AXIS_ATTRIBUTE) {
-                        if (cur->type == XML_ATTRIBUTE_NODE)
-			{
-                            if (prefix == NULL)
-			    {
-				XP_TEST_HIT
-                            } else if ((cur->ns != NULL) &&
-				(xmlStrEqual(URI, cur->ns->href)))
-			    {
-				XP_TEST_HIT
-                            }
-                        }
-                    } else if (axis == AXIS_NAMESPACE) {
-                        if (cur->type == XML_NAMESPACE_DECL)
-			{
-			    XP_TEST_HIT_NS
+                    break;
+                case NODE_TEST_ALL:
+                    if (axis == AXIS_ATTRIBUTE) {
+                        if (cur->type == XML_ATTRIBUTE_NODE)
+			{
+                            if (prefix == NULL)
+			    {
+				XP_TEST_HIT
+                            } else if (xmlXPathNsMatch(&nsTest, cur->ns))
+			    {
+				XP_TEST_HIT
+                            }
+                        }
+                    } else if (axis == AXIS_NAMESPACE) {
+                        if (cur->type == XML_NAMESPACE_DECL)
+			{
+			    XP_TEST_HIT_NS
+                        }
+                    } else {
+                        if (cur->type == XML_ELEMENT_NODE) {
+                            if (prefix == NULL)
+			    {
+				XP_TEST_HIT
+
+                            } else if (xmlXPathNsMatch(&nsTest, cur->ns))
+			    {
+				XP_TEST_HIT
+                            }
+                        }
+                    }
+                    break;
+                case NODE_TEST_NS:{
+                        /* TODO */
+                        break;
+                    }
+                case NODE_TEST_NAME:
+                    if (axis == AXIS_ATTRIBUTE) {
+                        if (cur->type != XML_ATTRIBUTE_NODE)
+			    break;
+		    } else if (axis == AXIS_NAMESPACE) {
+                        if (cur->type != XML_NAMESPACE_DECL)
+			    break;
+		    } else {
+		        if (cur->type != XML_ELEMENT_NODE)
+			    break;
+		    }
+                    switch (cur->type) {
+                        case XML_ELEMENT_NODE:
+                            if (xmlStrEqual(name, cur->name)) {
+                                if (prefix == NULL) {
+                                    if (cur->ns == NULL)
+				    {
+					XP_TEST_HIT
+                                    }
+                                } else {
+                                    if (xmlXPathNsMatch(&nsTest, cur->ns))
+				    {
+					XP_TEST_HIT
+                                    }
+                                }
+                            }
+                            break;
+                        case XML_ATTRIBUTE_NODE:{
+                                xmlAttrPtr attr = (xmlAttrPtr) cur;
+
+                                if (xmlStrEqual(name, attr->name)) {
+                                    if (prefix == NULL) {
+                                        if ((attr->ns == NULL) ||
+                                            (attr->ns->prefix == NULL))
+					{
+					    XP_TEST_HIT
+                                        }
+                                    } else {
+                                        if (xmlXPathNsMatch(&nsTest, attr->ns))
+					{
+					    XP_TEST_HIT
+                                        }
+                                    }
+                                }
+                                break;
+                            }
+                        case XML_NAMESPACE_DECL:
+                            if (cur->type == XML_NAMESPACE_DECL) {
+                                xmlNsPtr ns = (xmlNsPtr) cur;
+
+                                if ((ns->prefix != NULL) && (name != NULL)
+                                    && (xmlStrEqual(ns->prefix, name)))
+				{
+				    XP_TEST_HIT_NS
+                                }
+                            }
+                            break;
+                        default:
+                            break;
+                    }
+                    break;
+	    } /* switch(test) */
+        } while ((cur != NULL) && (ctxt->error == XPATH_EXPRESSION_OK));
+
+	goto apply_predicates;
+
+axis_range_end: /* ----------------------------------------------------- */
+	/*
+	* We have a "/foo[n]", and position() = n was reached.
+	* Note that we can have as well "/foo/::parent::foo[1]", so
+	* a duplicate-aware merge is still needed.
+	* Merge with the result.
+	*/
+	if (outSeq == NULL) {
+	    outSeq = seq;
+	    seq = NULL;
+	} else {
+	    outSeq = mergeAndClear(outSeq, seq);
+            if (outSeq == NULL)
+                xmlXPathPErrMemory(ctxt);
+        }
+	/*
+	* Break if only a true/false result was requested.
+	*/
+	if (toBool)
+	    break;
+	continue;
+
+first_hit: /* ---------------------------------------------------------- */
+	/*
+	* Break if only a true/false result was requested and
+	* no predicates existed and a node test succeeded.
+	*/
+	if (outSeq == NULL) {
+	    outSeq = seq;
+	    seq = NULL;
+	} else {
+	    outSeq = mergeAndClear(outSeq, seq);
+            if (outSeq == NULL)
+                xmlXPathPErrMemory(ctxt);
+        }
+	break;
+
+apply_predicates: /* --------------------------------------------------- */
+        if (ctxt->error != XPATH_EXPRESSION_OK)
+	    goto error;
+
+        /*
+	* Apply predicates.
+	*/
+        if ((predOp != NULL) && (!indexed) && (seq->nodeNr > 0)) {
+	    /*
+	    * E.g. when we have a "/foo[some expression][n]".
+	    */
+	    /*
+	    * QUESTION TODO: The old predicate evaluation took into
+	    *  account location-sets.
+	    *  (E.g. ctxt->value->type == XPATH_LOCATIONSET)
+	    *  Do we expect such a set here?
+	    *  All what I learned now from the evaluation semantics
+	    *  does not indicate that a location-set will be processed
+	    *  here, so this looks OK.
+	    */
+	    /*
+	    * Iterate over all predicates, starting with the outermost
+	    * predicate.
+	    * TODO: Problem: we cannot execute the inner predicates first
+	    *  since we cannot go back *up* the operator tree!
+	    *  Options we have:
+	    *  1) Use of recursive functions (like is it currently done
+	    *     via xmlXPathCompOpEval())
+	    *  2) Add a predicate evaluation information stack to the
+	    *     context struct
+	    *  3) Change the way the operators are linked; we need a
+	    *     "parent" field on xmlXPathStepOp
+	    *
+	    * For the moment, I'll try to solve this with a recursive
+	    * function: xmlXPathCompOpEvalPredicate().
+	    */
+	    if (hasPredicateRange != 0)
+		xmlXPathCompOpEvalPredicate(ctxt, predOp, seq, maxPos, maxPos,
+					    hasNsNodes);
+	    else
+		xmlXPathCompOpEvalPredicate(ctxt, predOp, seq, 1, seq->nodeNr,
+					    hasNsNodes);
+
+	    if (ctxt->error != XPATH_EXPRESSION_OK) {
+		total = 0;
+		goto error;
+	    }
+        }
+
+        if (seq->nodeNr > 0) {
+	    /*
+	    * Add to result set.
+	    */
+	    if (outSeq == NULL) {
+		outSeq = seq;
+		seq = NULL;
+	    } else {
+		outSeq = mergeAndClear(outSeq, seq);
+                if (outSeq == NULL)
+                    xmlXPathPErrMemory(ctxt);
+	    }
+
+            if (toBool)
+                break;
+	}
+    }
+
+error:
+    if ((obj->boolval) && (obj->user != NULL)) {
+	/*
+	* QUESTION TODO: What does this do and why?
+	* TODO: Do we have to do this also for the "error"
+	* cleanup further down?
+	*/
+	ctxt->value->boolval = 1;
+	ctxt->value->user = obj->user;
+	obj->user = NULL;
+	obj->boolval = 0;
+    }
+    xmlXPathReleaseObject(xpctxt, obj);
+    if (valueObj != NULL)
+        xmlXPathReleaseObject(xpctxt, valueObj);
+
+    /*
+    * Ensure we return at least an empty set.
+    */
+    if (outSeq == NULL) {
+	if ((seq != NULL) && (seq->nodeNr == 0)) {
+	    outSeq = seq;
+        } else {
+	    outSeq = xmlXPathNodeSetCreate(NULL);
+            if (outSeq == NULL)
+                xmlXPathPErrMemory(ctxt);
+        }
+    }
+    if ((seq != NULL) && (seq != outSeq)) {
+	 xmlXPathFreeNodeSet(seq);
+    }
+    /*
+    * Hand over the result. Better to push the set also in
+    * case of errors.
+    */
+    xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, outSeq));
+    /*
+    * Reset the context node.
+    */
+    xpctxt->node = oldContextNode;
+    /*
+    * When traversing the namespace axis in "toBool" mode, it's
+    * possible that tmpNsList wasn't freed.
+    */
+    if (xpctxt->tmpNsList != NULL) {
+        xmlFree(xpctxt->tmpNsList);
+        xpctxt->tmpNsList = NULL;
+    }
+
+    if (ctxt->profile != NULL)
+        ((xmlXPathOpProfile *) ctxt->profile)
+            [op - ctxt->comp->steps].visited += total;
+
+    return(total);
+}
+
+static int
+xmlXPathCompOpEvalFilterFirst(xmlXPathParserContextPtr ctxt,
+			      xmlXPathStepOpPtr op, xmlNodePtr * first);
+
+/**
+ * Evaluate the Precompiled XPath operation searching only the first
+ * element in document order
+ *
+ * @param ctxt  the XPath parser context with the compiled expression
+ * @param op  an XPath compiled operation
+ * @param first  the first elem found so far
+ * @returns the number of examined objects.
+ */
+static int
+xmlXPathCompOpEvalFirst(xmlXPathParserContextPtr ctxt,
+                        xmlXPathStepOpPtr op, xmlNodePtr * first)
+{
+    int total = 0, cur;
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr arg1, arg2;
+
+    CHECK_ERROR0;
+    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+        return(0);
+    if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
+        XP_ERROR0(XPATH_RECURSION_LIMIT_EXCEEDED);
+    ctxt->context->depth += 1;
+    comp = ctxt->comp;
+    switch (op->op) {
+        case XPATH_OP_END:
+            break;
+        case XPATH_OP_UNION:
+            total =
+                xmlXPathCompOpEvalFirst(ctxt, &comp->steps[op->ch1],
+                                        first);
+	    CHECK_ERROR0;
+            if ((ctxt->value != NULL)
+                && (ctxt->value->type == XPATH_NODESET)
+                && (ctxt->value->nodesetval != NULL)
+                && (ctxt->value->nodesetval->nodeNr >= 1)) {
+                /*
+                 * limit tree traversing to first node in the result
+                 */
+		/*
+		* OPTIMIZE TODO: This implicitly sorts
+		*  the result, even if not needed. E.g. if the argument
+		*  of the count() function, no sorting is needed.
+		* OPTIMIZE TODO: How do we know if the node-list wasn't
+		*  already sorted?
+		*/
+		if (ctxt->value->nodesetval->nodeNr > 1)
+		    xmlXPathNodeSetSort(ctxt->value->nodesetval);
+                *first = ctxt->value->nodesetval->nodeTab[0];
+            }
+            cur =
+                xmlXPathCompOpEvalFirst(ctxt, &comp->steps[op->ch2],
+                                        first);
+	    CHECK_ERROR0;
+
+            arg2 = xmlXPathValuePop(ctxt);
+            arg1 = xmlXPathValuePop(ctxt);
+            if ((arg1 == NULL) || (arg1->type != XPATH_NODESET) ||
+                (arg2 == NULL) || (arg2->type != XPATH_NODESET)) {
+	        xmlXPathReleaseObject(ctxt->context, arg1);
+	        xmlXPathReleaseObject(ctxt->context, arg2);
+                XP_ERROR0(XPATH_INVALID_TYPE);
+            }
+            if ((XP_HAS_LIMITS(ctxt->context)) &&
+                (((arg1->nodesetval != NULL) &&
+                  (xmlXPathCheckOpLimit(ctxt,
+                                        arg1->nodesetval->nodeNr) < 0)) ||
+                 ((arg2->nodesetval != NULL) &&
+                  (xmlXPathCheckOpLimit(ctxt,
+                                        arg2->nodesetval->nodeNr) < 0)))) {
+	        xmlXPathReleaseObject(ctxt->context, arg1);
+	        xmlXPathReleaseObject(ctxt->context, arg2);
+                break;
+            }
+
+            if ((arg2->nodesetval != NULL) &&
+                (arg2->nodesetval->nodeNr != 0)) {
+                arg1->nodesetval = xmlXPathNodeSetMerge(arg1->nodesetval,
+                                                        arg2->nodesetval);
+                if (arg1->nodesetval == NULL)
+                    xmlXPathPErrMemory(ctxt);
+            }
+            xmlXPathValuePush(ctxt, arg1);
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+            total += cur;
+            break;
+        case XPATH_OP_ROOT:
+            xmlXPathRoot(ctxt);
+            break;
+        case XPATH_OP_NODE:
+            if (op->ch1 != -1)
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            if (op->ch2 != -1)
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    CHECK_ERROR0;
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
+		ctxt->context->node));
+            break;
+        case XPATH_OP_COLLECT:{
+                if (op->ch1 == -1)
+                    break;
+
+                total = xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+		CHECK_ERROR0;
+
+                total += xmlXPathNodeCollectAndTest(ctxt, op, first, NULL, 0);
+                break;
+            }
+        case XPATH_OP_VALUE:
+            xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, op->value4));
+            break;
+        case XPATH_OP_SORT:
+            if (op->ch1 != -1)
+                total +=
+                    xmlXPathCompOpEvalFirst(ctxt, &comp->steps[op->ch1],
+                                            first);
+	    CHECK_ERROR0;
+            if ((ctxt->value != NULL)
+                && (ctxt->value->type == XPATH_NODESET)
+                && (ctxt->value->nodesetval != NULL)
+		&& (ctxt->value->nodesetval->nodeNr > 1))
+                xmlXPathNodeSetSort(ctxt->value->nodesetval);
+            break;
+#ifdef XP_OPTIMIZED_FILTER_FIRST
+	case XPATH_OP_FILTER:
+                total += xmlXPathCompOpEvalFilterFirst(ctxt, op, first);
+            break;
+#endif
+        default:
+            total += xmlXPathCompOpEval(ctxt, op);
+            break;
+    }
+
+    ctxt->context->depth -= 1;
+    return(total);
+}
+
+/**
+ * Evaluate the Precompiled XPath operation searching only the last
+ * element in document order
+ *
+ * @param ctxt  the XPath parser context with the compiled expression
+ * @param op  an XPath compiled operation
+ * @param last  the last elem found so far
+ * @returns the number of nodes traversed
+ */
+static int
+xmlXPathCompOpEvalLast(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op,
+                       xmlNodePtr * last)
+{
+    int total = 0, cur;
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr arg1, arg2;
+
+    CHECK_ERROR0;
+    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+        return(0);
+    if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
+        XP_ERROR0(XPATH_RECURSION_LIMIT_EXCEEDED);
+    ctxt->context->depth += 1;
+    comp = ctxt->comp;
+    switch (op->op) {
+        case XPATH_OP_END:
+            break;
+        case XPATH_OP_UNION:
+            total =
+                xmlXPathCompOpEvalLast(ctxt, &comp->steps[op->ch1], last);
+	    CHECK_ERROR0;
+            if ((ctxt->value != NULL)
+                && (ctxt->value->type == XPATH_NODESET)
+                && (ctxt->value->nodesetval != NULL)
+                && (ctxt->value->nodesetval->nodeNr >= 1)) {
+                /*
+                 * limit tree traversing to first node in the result
+                 */
+		if (ctxt->value->nodesetval->nodeNr > 1)
+		    xmlXPathNodeSetSort(ctxt->value->nodesetval);
+                *last =
+                    ctxt->value->nodesetval->nodeTab[ctxt->value->
+                                                     nodesetval->nodeNr -
+                                                     1];
+            }
+            cur =
+                xmlXPathCompOpEvalLast(ctxt, &comp->steps[op->ch2], last);
+	    CHECK_ERROR0;
+            if ((ctxt->value != NULL)
+                && (ctxt->value->type == XPATH_NODESET)
+                && (ctxt->value->nodesetval != NULL)
+                && (ctxt->value->nodesetval->nodeNr >= 1)) { /* TODO: NOP ? */
+            }
+
+            arg2 = xmlXPathValuePop(ctxt);
+            arg1 = xmlXPathValuePop(ctxt);
+            if ((arg1 == NULL) || (arg1->type != XPATH_NODESET) ||
+                (arg2 == NULL) || (arg2->type != XPATH_NODESET)) {
+	        xmlXPathReleaseObject(ctxt->context, arg1);
+	        xmlXPathReleaseObject(ctxt->context, arg2);
+                XP_ERROR0(XPATH_INVALID_TYPE);
+            }
+            if ((XP_HAS_LIMITS(ctxt->context)) &&
+                (((arg1->nodesetval != NULL) &&
+                  (xmlXPathCheckOpLimit(ctxt,
+                                        arg1->nodesetval->nodeNr) < 0)) ||
+                 ((arg2->nodesetval != NULL) &&
+                  (xmlXPathCheckOpLimit(ctxt,
+                                        arg2->nodesetval->nodeNr) < 0)))) {
+	        xmlXPathReleaseObject(ctxt->context, arg1);
+	        xmlXPathReleaseObject(ctxt->context, arg2);
+                break;
+            }
+
+            if ((arg2->nodesetval != NULL) &&
+                (arg2->nodesetval->nodeNr != 0)) {
+                arg1->nodesetval = xmlXPathNodeSetMerge(arg1->nodesetval,
+                                                        arg2->nodesetval);
+                if (arg1->nodesetval == NULL)
+                    xmlXPathPErrMemory(ctxt);
+            }
+            xmlXPathValuePush(ctxt, arg1);
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+            total += cur;
+            break;
+        case XPATH_OP_ROOT:
+            xmlXPathRoot(ctxt);
+            break;
+        case XPATH_OP_NODE:
+            if (op->ch1 != -1)
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            if (op->ch2 != -1)
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    CHECK_ERROR0;
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
+		ctxt->context->node));
+            break;
+        case XPATH_OP_COLLECT:{
+                if (op->ch1 == -1)
+                    break;
+
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+		CHECK_ERROR0;
+
+                total += xmlXPathNodeCollectAndTest(ctxt, op, NULL, last, 0);
+                break;
+            }
+        case XPATH_OP_VALUE:
+            xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, op->value4));
+            break;
+        case XPATH_OP_SORT:
+            if (op->ch1 != -1)
+                total +=
+                    xmlXPathCompOpEvalLast(ctxt, &comp->steps[op->ch1],
+                                           last);
+	    CHECK_ERROR0;
+            if ((ctxt->value != NULL)
+                && (ctxt->value->type == XPATH_NODESET)
+                && (ctxt->value->nodesetval != NULL)
+		&& (ctxt->value->nodesetval->nodeNr > 1))
+                xmlXPathNodeSetSort(ctxt->value->nodesetval);
+            break;
+        default:
+            total += xmlXPathCompOpEval(ctxt, op);
+            break;
+    }
+
+    ctxt->context->depth -= 1;
+    return (total);
+}
+
+#ifdef XP_OPTIMIZED_FILTER_FIRST
+static int
+xmlXPathCompOpEvalFilterFirst(xmlXPathParserContextPtr ctxt,
+			      xmlXPathStepOpPtr op, xmlNodePtr * first)
+{
+    int total = 0;
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr obj;
+    xmlNodeSetPtr set;
+
+    CHECK_ERROR0;
+    comp = ctxt->comp;
+    /*
+    * Optimization for ()[last()] selection i.e. the last elem
+    */
+    if ((op->ch1 != -1) && (op->ch2 != -1) &&
+	(comp->steps[op->ch1].op == XPATH_OP_SORT) &&
+	(comp->steps[op->ch2].op == XPATH_OP_SORT)) {
+	int f = comp->steps[op->ch2].ch1;
+
+	if ((f != -1) &&
+	    (comp->steps[f].op == XPATH_OP_FUNCTION) &&
+	    (comp->steps[f].value5 == NULL) &&
+	    (comp->steps[f].value == 0) &&
+	    (comp->steps[f].value4 != NULL) &&
+	    (xmlStrEqual
+	    (comp->steps[f].value4, BAD_CAST "last"))) {
+	    xmlNodePtr last = NULL;
+
+	    total +=
+		xmlXPathCompOpEvalLast(ctxt,
+		    &comp->steps[op->ch1],
+		    &last);
+	    CHECK_ERROR0;
+	    /*
+	    * The nodeset should be in document order,
+	    * Keep only the last value
+	    */
+	    if ((ctxt->value != NULL) &&
+		(ctxt->value->type == XPATH_NODESET) &&
+		(ctxt->value->nodesetval != NULL) &&
+		(ctxt->value->nodesetval->nodeTab != NULL) &&
+		(ctxt->value->nodesetval->nodeNr > 1)) {
+                xmlXPathNodeSetKeepLast(ctxt->value->nodesetval);
+		*first = *(ctxt->value->nodesetval->nodeTab);
+	    }
+	    return (total);
+	}
+    }
+
+    if (op->ch1 != -1)
+	total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+    CHECK_ERROR0;
+    if (op->ch2 == -1)
+	return (total);
+    if (ctxt->value == NULL)
+	return (total);
+
+    /*
+     * In case of errors, xmlXPathNodeSetFilter can pop additional nodes from
+     * the stack. We have to temporarily remove the nodeset object from the
+     * stack to avoid freeing it prematurely.
+     */
+    CHECK_TYPE0(XPATH_NODESET);
+    obj = xmlXPathValuePop(ctxt);
+    set = obj->nodesetval;
+    if (set != NULL) {
+        xmlXPathNodeSetFilter(ctxt, set, op->ch2, 1, 1, 1);
+        if (set->nodeNr > 0)
+            *first = set->nodeTab[0];
+    }
+    xmlXPathValuePush(ctxt, obj);
+
+    return (total);
+}
+#endif /* XP_OPTIMIZED_FILTER_FIRST */
+
+static int
+xmlXPathCompOpEvalInternal(xmlXPathParserContextPtr ctxt,
+                           xmlXPathStepOpPtr op);
+
+/**
+ * Evaluate the Precompiled XPath operation and update its counters.
+ *
+ * @param ctxt  the XPath parser context with the compiled expression
+ * @param op  an XPath compiled operation
+ * @returns the number of nodes traversed
+ */
+static int
+xmlXPathCompOpEvalProfile(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op)
+{
+    xmlXPathOpProfile *profile =
+        &((xmlXPathOpProfile *) ctxt->profile)[op - ctxt->comp->steps];
+    int valueNr = ctxt->valueNr;
+    clock_t start;
+    int total;
+
+    start = clock();
+    total = xmlXPathCompOpEvalInternal(ctxt, op);
+    profile->time += (double) (clock() - start) / CLOCKS_PER_SEC;
+    profile->count += 1;
+    if ((ctxt->valueNr > valueNr) && (ctxt->value != NULL) &&
+        (ctxt->value->type == XPATH_NODESET) &&
+        (ctxt->value->nodesetval != NULL))
+        profile->produced += ctxt->value->nodesetval->nodeNr;
+
+    return(total);
+}
+
+/**
+ * Evaluate a context independent subexpression. The value is computed
+ * once per document of the context and copied afterwards.
+ *
+ * @param ctxt  the XPath parser context with the compiled expression
+ * @param op  an XPath compiled operation with an invariant slot
+ * @returns the number of nodes traversed
+ */
+static int
+xmlXPathCompOpEvalInvariant(xmlXPathParserContextPtr ctxt,
+                            xmlXPathStepOpPtr op)
+{
+    xmlXPathInvariants *inv = ctxt->invariants;
+    xmlXPathInvariantValue *slot = NULL;
+    xmlDocPtr doc = ctxt->context->doc;
+    int valueNr = ctxt->valueNr;
+    int total;
+
+    if ((inv == NULL) && (ctxt->comp->nbInvariant > 0)) {
+        int nb = ctxt->comp->nbInvariant;
+
+        inv = xmlMalloc(sizeof(*inv) + nb * sizeof(inv->tab[0]));
+        if (inv != NULL) {
+            inv->nb = nb;
+            inv->tab = (xmlXPathInvariantValue *) (inv + 1);
+            memset(inv->tab, 0, nb * sizeof(inv->tab[0]));
+            ctxt->invariants = inv;
+        }
+    }
+    if ((inv != NULL) && (op->invariant <= inv->nb)) {
+        slot = &inv->tab[op->invariant - 1];
+        if ((slot->value != NULL) && (slot->doc == doc)) {
+            CHECK_ERROR0;
+            xmlXPathValuePush(ctxt,
+                              xmlXPathCacheObjectCopy(ctxt, slot->value));
+            return(0);
+        }
+    }
+
+    if (ctxt->profile != NULL)
+        total = xmlXPathCompOpEvalProfile(ctxt, op);
+    else
+        total = xmlXPathCompOpEvalInternal(ctxt, op);
+
+    if ((slot != NULL) && (ctxt->error == XPATH_EXPRESSION_OK) &&
+        (ctxt->valueNr == valueNr + 1)) {
+        xmlXPathObjectPtr copy = xmlXPathObjectCopy(ctxt->value);
+
+        if (copy != NULL) {
+            xmlXPathFreeObject(slot->value);
+            slot->value = copy;
+            slot->doc = doc;
+        }
+    }
+
+    return(total);
+}
+
+/**
+ * Evaluate the Precompiled XPath operation
+ *
+ * @param ctxt  the XPath parser context with the compiled expression
+ * @param op  an XPath compiled operation
+ * @returns the number of nodes traversed
+ */
+static int
+xmlXPathCompOpEval(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op)
+{
+    if (op->invariant > 0)
+        return(xmlXPathCompOpEvalInvariant(ctxt, op));
+    if (ctxt->profile != NULL)
+        return(xmlXPathCompOpEvalProfile(ctxt, op));
+    return(xmlXPathCompOpEvalInternal(ctxt, op));
+}
+
+/**
+ * Evaluate a comparison of count() with zero marked as XPATH_FAST_EXISTS
+ * by checking whether the node-set is empty. This stops at the first
+ * node found.
+ *
+ * @param ctxt  the XPath parser context with the compiled expression
+ * @param op  an XPATH_OP_CMP or XPATH_OP_EQUAL operation
+ * @returns 1 if the node-set isn't empty, 0 if it is empty, -1 on error
+ */
+static int
+xmlXPathCompOpEvalExists(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op)
+{
+    xmlXPathCompExprPtr comp = ctxt->comp;
+    xmlXPathStepOpPtr countOp;
+
+    countOp = &comp->steps[op->ch1];
+    if (countOp->op != XPATH_OP_FUNCTION)
+        countOp = &comp->steps[op->ch2];
+
+    return(xmlXPathCompOpEvalToBoolean(ctxt,
+                &comp->steps[comp->steps[countOp->ch1].ch2], 0));
+}
+
+static int
+xmlXPathCompOpEvalInternal(xmlXPathParserContextPtr ctxt,
+                           xmlXPathStepOpPtr op)
+{
+    int total = 0;
+    int equal, ret;
+    xmlXPathCompExprPtr comp;
+    xmlXPathObjectPtr arg1, arg2;
+
+    CHECK_ERROR0;
+    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+        return(0);
+    if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
+        XP_ERROR0(XPATH_RECURSION_LIMIT_EXCEEDED);
+    ctxt->context->depth += 1;
+    comp = ctxt->comp;
+    switch (op->op) {
+        case XPATH_OP_END:
+            break;
+        case XPATH_OP_AND:
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            xmlXPathBooleanFunction(ctxt, 1);
+            if ((ctxt->value == NULL) || (ctxt->value->boolval == 0))
+                break;
+            arg2 = xmlXPathValuePop(ctxt);
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    if (ctxt->error) {
+		xmlXPathFreeObject(arg2);
+		break;
+	    }
+            xmlXPathBooleanFunction(ctxt, 1);
+            if (ctxt->value != NULL)
+                ctxt->value->boolval &= arg2->boolval;
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+            break;
+        case XPATH_OP_OR:
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            xmlXPathBooleanFunction(ctxt, 1);
+            if ((ctxt->value == NULL) || (ctxt->value->boolval == 1))
+                break;
+            arg2 = xmlXPathValuePop(ctxt);
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    if (ctxt->error) {
+		xmlXPathFreeObject(arg2);
+		break;
+	    }
+            xmlXPathBooleanFunction(ctxt, 1);
+            if (ctxt->value != NULL)
+                ctxt->value->boolval |= arg2->boolval;
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+            break;
+        case XPATH_OP_EQUAL:
+            if (op->fast == XPATH_FAST_EXISTS) {
+                ret = xmlXPathCompOpEvalExists(ctxt, op);
+                CHECK_ERROR0;
+                xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, ret));
+                break;
+            }
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    CHECK_ERROR0;
+	    if (op->value)
+		equal = xmlXPathEqualValues(ctxt);
+	    else
+		equal = xmlXPathNotEqualValues(ctxt);
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, equal));
+            break;
+        case XPATH_OP_CMP:
+            if (op->fast == XPATH_FAST_EXISTS) {
+                ret = xmlXPathCompOpEvalExists(ctxt, op);
+                CHECK_ERROR0;
+                xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, ret));
+                break;
+            }
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    CHECK_ERROR0;
+            ret = xmlXPathCompareValues(ctxt, op->value, op->value2);
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, ret));
+            break;
+        case XPATH_OP_PLUS:
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            if (op->ch2 != -1) {
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    }
+	    CHECK_ERROR0;
+            if (op->value == 0)
+                xmlXPathSubValues(ctxt);
+            else if (op->value == 1)
+                xmlXPathAddValues(ctxt);
+            else if (op->value == 2)
+                xmlXPathValueFlipSign(ctxt);
+            else if (op->value == 3) {
+                CAST_TO_NUMBER;
+                CHECK_TYPE0(XPATH_NUMBER);
+            }
+            break;
+        case XPATH_OP_MULT:
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    CHECK_ERROR0;
+            if (op->value == 0)
+                xmlXPathMultValues(ctxt);
+            else if (op->value == 1)
+                xmlXPathDivValues(ctxt);
+            else if (op->value == 2)
+                xmlXPathModValues(ctxt);
+            break;
+        case XPATH_OP_UNION:
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    CHECK_ERROR0;
+
+            arg2 = xmlXPathValuePop(ctxt);
+            arg1 = xmlXPathValuePop(ctxt);
+            if ((arg1 == NULL) || (arg1->type != XPATH_NODESET) ||
+                (arg2 == NULL) || (arg2->type != XPATH_NODESET)) {
+	        xmlXPathReleaseObject(ctxt->context, arg1);
+	        xmlXPathReleaseObject(ctxt->context, arg2);
+                XP_ERROR0(XPATH_INVALID_TYPE);
+            }
+            if ((XP_HAS_LIMITS(ctxt->context)) &&
+                (((arg1->nodesetval != NULL) &&
+                  (xmlXPathCheckOpLimit(ctxt,
+                                        arg1->nodesetval->nodeNr) < 0)) ||
+                 ((arg2->nodesetval != NULL) &&
+                  (xmlXPathCheckOpLimit(ctxt,
+                                        arg2->nodesetval->nodeNr) < 0)))) {
+	        xmlXPathReleaseObject(ctxt->context, arg1);
+	        xmlXPathReleaseObject(ctxt->context, arg2);
+                break;
+            }
+
+	    if (((arg2->nodesetval != NULL) &&
+		 (arg2->nodesetval->nodeNr != 0)))
+	    {
+		arg1->nodesetval = xmlXPathNodeSetMerge(arg1->nodesetval,
+							arg2->nodesetval);
+                if (arg1->nodesetval == NULL)
+                    xmlXPathPErrMemory(ctxt);
+	    }
+
+            xmlXPathValuePush(ctxt, arg1);
+	    xmlXPathReleaseObject(ctxt->context, arg2);
+            break;
+        case XPATH_OP_ROOT:
+            xmlXPathRoot(ctxt);
+            break;
+        case XPATH_OP_NODE:
+            if (op->ch1 != -1)
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            if (op->ch2 != -1)
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	    CHECK_ERROR0;
+	    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
+                                                    ctxt->context->node));
+            break;
+        case XPATH_OP_COLLECT:{
+                if (op->ch1 == -1)
+                    break;
+
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+		CHECK_ERROR0;
+
+                total += xmlXPathNodeCollectAndTest(ctxt, op, NULL, NULL, 0);
+                break;
+            }
+        case XPATH_OP_VALUE:
+            xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, op->value4));
+            break;
+        case XPATH_OP_VARIABLE:{
+		xmlXPathObjectPtr val;
+
+                if (op->ch1 != -1)
+                    total +=
+                        xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+                if (op->value5 == NULL) {
+		    val = xmlXPathVariableLookup(ctxt->context, op->value4);
+		    if (val == NULL) {
+                        xmlXPathErrFmt(ctxt, XPATH_UNDEF_VARIABLE_ERROR,
+                                       "Undefined variable: %s\n", op->value4);
+                        return 0;
+                    }
+                    xmlXPathValuePush(ctxt, val);
+		} else {
+                    const xmlChar *URI;
+
+                    URI = xmlXPathNsLookup(ctxt->context, op->value5);
+                    if (URI == NULL) {
+                        xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
+                                       "Undefined namespace prefix: %s\n",
+                                       op->value5);
+                        return 0;
+                    }
+		    val = xmlXPathVariableLookupNS(ctxt->context,
+                                                       op->value4, URI);
+		    if (val == NULL) {
+                        xmlXPathErrFmt(ctxt, XPATH_UNDEF_VARIABLE_ERROR,
+                                       "Undefined variable: %s:%s\n",
+                                       op->value5, op->value4);
+                        return 0;
+                    }
+                    xmlXPathValuePush(ctxt, val);
+                }
+                break;
+            }
+        case XPATH_OP_FUNCTION:{
+                xmlXPathFunction func;
+                const xmlChar *oldFunc, *oldFuncURI, *URI;
+		int i;
+                int frame;
+
+                frame = ctxt->valueNr;
+                if (op->ch1 != -1) {
+                    total +=
+                        xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+                    if (ctxt->error != XPATH_EXPRESSION_OK)
+                        break;
+                }
+		if (ctxt->valueNr < frame + op->value)
+		    XP_ERROR0(XPATH_INVALID_OPERAND);
+		for (i = 0; i < op->value; i++) {
+		    if (ctxt->valueTab[(ctxt->valueNr - 1) - i] == NULL)
+			XP_ERROR0(XPATH_INVALID_OPERAND);
+                }
+                /*
+                 * Standard functions are bound at compile time. Others
+                 * are looked up on every call and never stored in the
+                 * shared operation, so that compiled expressions stay
+                 * read-only.
+                 */
+                URI = NULL;
+                if (op->cache != NULL)
+                    func = op->cache;
+                else {
+                    if (op->value5 == NULL) {
+                        func = xmlXPathFunctionLookup(ctxt->context,
+                                                      op->value4);
+                        if (func == NULL) {
+                            xmlXPathErrFmt(ctxt, XPATH_UNKNOWN_FUNC_ERROR,
+                                           "Unregistered function: %s\n",
+                                           op->value4);
+                            return 0;
                         }
                     } else {
-                        if (cur->type == XML_ELEMENT_NODE) {
-                            if (prefix == NULL)
-			    {
-				XP_TEST_HIT
+                        URI = xmlXPathNsLookup(ctxt->context, op->value5);
+                        if (URI == NULL) {
+                            xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
+                                           "Undefined namespace prefix: %s\n",
+                                           op->value5);
+                            return 0;
+                        }
+                        func = xmlXPathFunctionLookupNS(ctxt->context,
+                                                        op->value4, URI);
+                        if (func == NULL) {
+                            xmlXPathErrFmt(ctxt, XPATH_UNKNOWN_FUNC_ERROR,
+                                           "Unregistered function: %s:%s\n",
+                                           op->value5, op->value4);
+                            return 0;
+                        }
+                    }
+                }
+                oldFunc = ctxt->context->function;
+                oldFuncURI = ctxt->context->functionURI;
+                ctxt->context->function = op->value4;
+                ctxt->context->functionURI = URI;
+                func(ctxt, op->value);
+                ctxt->context->function = oldFunc;
+                ctxt->context->functionURI = oldFuncURI;
+                if ((ctxt->error == XPATH_EXPRESSION_OK) &&
+                    (ctxt->valueNr != frame + 1))
+                    XP_ERROR0(XPATH_STACK_ERROR);
+                break;
+            }
+        case XPATH_OP_ARG:
+            if (op->ch1 != -1) {
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	        CHECK_ERROR0;
+            }
+            if (op->ch2 != -1) {
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
+	        CHECK_ERROR0;
+	    }
+            break;
+        case XPATH_OP_PREDICATE:
+        case XPATH_OP_FILTER:{
+                xmlXPathObjectPtr obj;
+                xmlNodeSetPtr set;
+
+                /*
+                 * Optimization for ()[1] selection i.e. the first elem
+                 */
+                if ((op->ch1 != -1) && (op->ch2 != -1) &&
+#ifdef XP_OPTIMIZED_FILTER_FIRST
+		    /*
+		    * FILTER TODO: Can we assume that the inner processing
+		    *  will result in an ordered list if we have an
+		    *  XPATH_OP_FILTER?
+		    *  What about an additional field or flag on
+		    *  xmlXPathObject like @sorted ? This way we wouldn't need
+		    *  to assume anything, so it would be more robust and
+		    *  easier to optimize.
+		    */
+                    ((comp->steps[op->ch1].op == XPATH_OP_SORT) || /* 18 */
+		     (comp->steps[op->ch1].op == XPATH_OP_FILTER)) && /* 17 */
+#else
+		    (comp->steps[op->ch1].op == XPATH_OP_SORT) &&
+#endif
+                    (comp->steps[op->ch2].op == XPATH_OP_VALUE)) { /* 12 */
+                    xmlXPathObjectPtr val;
+
+                    val = comp->steps[op->ch2].value4;
+                    if ((val != NULL) && (val->type == XPATH_NUMBER) &&
+                        (val->floatval == 1.0)) {
+                        xmlNodePtr first = NULL;
+
+                        total +=
+                            xmlXPathCompOpEvalFirst(ctxt,
+                                                    &comp->steps[op->ch1],
+                                                    &first);
+			CHECK_ERROR0;
+                        /*
+                         * The nodeset should be in document order,
+                         * Keep only the first value
+                         */
+                        if ((ctxt->value != NULL) &&
+                            (ctxt->value->type == XPATH_NODESET) &&
+                            (ctxt->value->nodesetval != NULL) &&
+                            (ctxt->value->nodesetval->nodeNr > 1))
+                            xmlXPathNodeSetClearFromPos(ctxt->value->nodesetval,
+                                                        1, 1);
+                        break;
+                    }
+                }
+                /*
+                 * Optimization for ()[last()] selection i.e. the last elem
+                 */
+                if ((op->ch1 != -1) && (op->ch2 != -1) &&
+                    (comp->steps[op->ch1].op == XPATH_OP_SORT) &&
+                    (comp->steps[op->ch2].op == XPATH_OP_SORT)) {
+                    int f = comp->steps[op->ch2].ch1;
+
+                    if ((f != -1) &&
+                        (comp->steps[f].op == XPATH_OP_FUNCTION) &&
+                        (comp->steps[f].value5 == NULL) &&
+                        (comp->steps[f].value == 0) &&
+                        (comp->steps[f].value4 != NULL) &&
+                        (xmlStrEqual
+                         (comp->steps[f].value4, BAD_CAST "last"))) {
+                        xmlNodePtr last = NULL;
+
+                        total +=
+                            xmlXPathCompOpEvalLast(ctxt,
+                                                   &comp->steps[op->ch1],
+                                                   &last);
+			CHECK_ERROR0;
+                        /*
+                         * The nodeset should be in document order,
+                         * Keep only the last value
+                         */
+                        if ((ctxt->value != NULL) &&
+                            (ctxt->value->type == XPATH_NODESET) &&
+                            (ctxt->value->nodesetval != NULL) &&
+                            (ctxt->value->nodesetval->nodeTab != NULL) &&
+                            (ctxt->value->nodesetval->nodeNr > 1))
+                            xmlXPathNodeSetKeepLast(ctxt->value->nodesetval);
+                        break;
+                    }
+                }
+		/*
+		* Process inner predicates first.
+		* Example "index[parent::book][1]":
+		* ...
+		*   PREDICATE   <-- we are here "[1]"
+		*     PREDICATE <-- process "[parent::book]" first
+		*       SORT
+		*         COLLECT  'parent' 'name' 'node' book
+		*           NODE
+		*     ELEM Object is a number : 1
+		*/
+                if (op->ch1 != -1)
+                    total +=
+                        xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+		CHECK_ERROR0;
+                if (op->ch2 == -1)
+                    break;
+                if (ctxt->value == NULL)
+                    break;
+
+                /*
+                 * In case of errors, xmlXPathNodeSetFilter can pop additional
+                 * nodes from the stack. We have to temporarily remove the
+                 * nodeset object from the stack to avoid freeing it
+                 * prematurely.
+                 */
+                CHECK_TYPE0(XPATH_NODESET);
+                obj = xmlXPathValuePop(ctxt);
+                set = obj->nodesetval;
+                if (set != NULL)
+                    xmlXPathNodeSetFilter(ctxt, set, op->ch2,
+                                          1, set->nodeNr, 1);
+                xmlXPathValuePush(ctxt, obj);
+                break;
+            }
+        case XPATH_OP_SORT:
+            if (op->ch1 != -1)
+                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
+	    CHECK_ERROR0;
+            if ((ctxt->value != NULL) &&
+                (ctxt->value->type == XPATH_NODESET) &&
+                (ctxt->value->nodesetval != NULL) &&
+		(ctxt->value->nodesetval->nodeNr > 1))
+	    {
+                xmlXPathNodeSetSort(ctxt->value->nodesetval);
+	    }
+            break;
+        default:
+            XP_ERROR0(XPATH_INVALID_OPERAND);
+            break;
+    }
 
-                            } else if ((cur->ns != NULL) &&
-				(xmlStrEqual(URI, cur->ns->href)))
-			    {
-				XP_TEST_HIT
-                            }
-                        }
-                    }
-                    break;
-                case NODE_TEST_NS:{
-                        /* TODO */
-                        break;
-                    }
-                case NODE_TEST_NAME:
-                    if (axis == AXIS_ATTRIBUTE) {
-                        if (cur->type != XML_ATTRIBUTE_NODE)
-			    break;
-		    } else if (axis == AXIS_NAMESPACE) {
-                        if (cur->type != XML_NAMESPACE_DECL)
-			    break;
-		    } else {
-		        if (cur->type != XML_ELEMENT_NODE)
-			    break;
-		    }
-                    switch (cur->type) {
-                        case XML_ELEMENT_NODE:
-                            if (xmlStrEqual(name, cur->name)) {
-                                if (prefix == NULL) {
-                                    if (cur->ns == NULL)
-				    {
-					XP_TEST_HIT
-                                    }
-                                } else {
-                                    if ((cur->ns != NULL) &&
-                                        (xmlStrEqual(URI, cur->ns->href)))
-				    {
-					XP_TEST_HIT
-                                    }
-                                }
-                            }
-                            break;
-                        case XML_ATTRIBUTE_NODE:{
-                                xmlAttrPtr attr = (xmlAttrPtr) cur;
+    ctxt->context->depth -= 1;
+    return (total);
+}
 
-                                if (xmlStrEqual(name, attr->name)) {
-                                    if (prefix == NULL) {
-                                        if ((attr->ns == NULL) ||
-                                            (attr->ns->prefix == NULL))
-					{
-					    XP_TEST_HIT
-                                        }
-                                    } else {
-                                        if ((attr->ns != NULL) &&
-                                            (xmlStrEqual(URI,
-					      attr->ns->href)))
-					{
-					    XP_TEST_HIT
-                                        }
-                                    }
-                                }
-                                break;
-                            }
-                        case XML_NAMESPACE_DECL:
-                            if (cur->type == XML_NAMESPACE_DECL) {
-                                xmlNsPtr ns = (xmlNsPtr) cur;
+/**
+ * Evaluates if the expression evaluates to true.
+ *
+ * @param ctxt  the XPath parser context
+ * @param op  the step operation
+ * @param isPredicate  whether a predicate is evaluated
+ * @returns 1 if true, 0 if false and -1 on API or internal errors.
+ */
+static int
+xmlXPathCompOpEvalToBoolean(xmlXPathParserContextPtr ctxt,
+			    xmlXPathStepOpPtr op,
+			    int isPredicate)
+{
+    xmlXPathObjectPtr resObj = NULL;
+
+start:
+    if (OP_LIMIT_EXCEEDED(ctxt, 1))
+        return(0);
+    /* comp = ctxt->comp; */
+    switch (op->op) {
+        case XPATH_OP_END:
+            return (0);
+	case XPATH_OP_VALUE:
+	    resObj = (xmlXPathObjectPtr) op->value4;
+	    if (isPredicate)
+		return(xmlXPathEvaluatePredicateResult(ctxt, resObj));
+	    return(xmlXPathCastToBoolean(resObj));
+	case XPATH_OP_SORT:
+	    /*
+	    * We don't need sorting for boolean results. Skip this one.
+	    */
+            if (op->ch1 != -1) {
+		op = &ctxt->comp->steps[op->ch1];
+		goto start;
+	    }
+	    return(0);
+	case XPATH_OP_COLLECT:
+	    if (op->ch1 == -1)
+		return(0);
+
+            xmlXPathCompOpEval(ctxt, &ctxt->comp->steps[op->ch1]);
+	    if (ctxt->error != XPATH_EXPRESSION_OK)
+		return(-1);
+
+            xmlXPathNodeCollectAndTest(ctxt, op, NULL, NULL, 1);
+	    if (ctxt->error != XPATH_EXPRESSION_OK)
+		return(-1);
+
+	    resObj = xmlXPathValuePop(ctxt);
+	    if (resObj == NULL)
+		return(-1);
+	    break;
+	default:
+	    /*
+	    * Fallback to call xmlXPathCompOpEval().
+	    */
+	    xmlXPathCompOpEval(ctxt, op);
+	    if (ctxt->error != XPATH_EXPRESSION_OK)
+		return(-1);
+
+	    resObj = xmlXPathValuePop(ctxt);
+	    if (resObj == NULL)
+		return(-1);
+	    break;
+    }
+
+    if (resObj) {
+	int res;
+
+	if (resObj->type == XPATH_BOOLEAN) {
+	    res = resObj->boolval;
+	} else if (isPredicate) {
+	    /*
+	    * For predicates a result of type "number" is handled
+	    * differently:
+	    * SPEC XPath 1.0:
+	    * "If the result is a number, the result will be converted
+	    *  to true if the number is equal to the context position
+	    *  and will be converted to false otherwise;"
+	    */
+	    res = xmlXPathEvaluatePredicateResult(ctxt, resObj);
+	} else {
+	    res = xmlXPathCastToBoolean(resObj);
+	}
+	xmlXPathReleaseObject(ctxt->context, resObj);
+	return(res);
+    }
+
+    return(0);
+}
+
+#ifdef XPATH_STREAMING
+/**
+ * Evaluate the Precompiled Streamable XPath expression in the given context.
+ *
+ * @param pctxt  the XPath parser context with the compiled expression
+ */
+static int
+xmlXPathRunStreamEval(xmlXPathParserContextPtr pctxt, xmlPatternPtr comp,
+		      xmlXPathObjectPtr *resultSeq, int toBool)
+{
+    int max_depth, min_depth;
+    int from_root;
+    int ret, depth;
+    int eval_all_nodes;
+    xmlNodePtr cur = NULL, limit = NULL;
+    xmlStreamCtxtPtr patstream = NULL;
+    xmlXPathContextPtr ctxt = pctxt->context;
+
+    if ((ctxt == NULL) || (comp == NULL))
+        return(-1);
+    max_depth = xmlPatternMaxDepth(comp);
+    if (max_depth == -1)
+        return(-1);
+    if (max_depth == -2)
+        max_depth = 10000;
+    min_depth = xmlPatternMinDepth(comp);
+    if (min_depth == -1)
+        return(-1);
+    from_root = xmlPatternFromRoot(comp);
+    if (from_root < 0)
+        return(-1);
+
+    if (! toBool) {
+	if (resultSeq == NULL)
+	    return(-1);
+	*resultSeq = xmlXPathCacheNewNodeSet(pctxt, NULL);
+	if (*resultSeq == NULL)
+	    return(-1);
+    }
+
+    /*
+     * handle the special cases of "/" amd "." being matched
+     */
+    if (min_depth == 0) {
+        int res;
+
+	if (from_root) {
+	    /* Select "/" */
+	    if (toBool)
+		return(1);
+            res = xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval,
+                                           (xmlNodePtr) ctxt->doc);
+	} else {
+	    /* Select "self::node()" */
+	    if (toBool)
+		return(1);
+            res = xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval,
+                                           ctxt->node);
+	}
+
+        if (res < 0)
+            xmlXPathPErrMemory(pctxt);
+    }
+    if (max_depth == 0) {
+	return(0);
+    }
+
+    if (from_root) {
+        cur = (xmlNodePtr)ctxt->doc;
+    } else if (ctxt->node != NULL) {
+        switch (ctxt->node->type) {
+            case XML_ELEMENT_NODE:
+            case XML_DOCUMENT_NODE:
+            case XML_DOCUMENT_FRAG_NODE:
+            case XML_HTML_DOCUMENT_NODE:
+	        cur = ctxt->node;
+		break;
+            case XML_ATTRIBUTE_NODE:
+            case XML_TEXT_NODE:
+            case XML_CDATA_SECTION_NODE:
+            case XML_ENTITY_REF_NODE:
+            case XML_ENTITY_NODE:
+            case XML_PI_NODE:
+            case XML_COMMENT_NODE:
+            case XML_NOTATION_NODE:
+            case XML_DTD_NODE:
+            case XML_DOCUMENT_TYPE_NODE:
+            case XML_ELEMENT_DECL:
+            case XML_ATTRIBUTE_DECL:
+            case XML_ENTITY_DECL:
+            case XML_NAMESPACE_DECL:
+            case XML_XINCLUDE_START:
+            case XML_XINCLUDE_END:
+		break;
+	}
+	limit = cur;
+    }
+    if (cur == NULL) {
+        return(0);
+    }
 
-                                if ((ns->prefix != NULL) && (name != NULL)
-                                    && (xmlStrEqual(ns->prefix, name)))
-				{
-				    XP_TEST_HIT_NS
-                                }
-                            }
-                            break;
-                        default:
-                            break;
-                    }
-                    break;
-	    } /* switch(test) */
-        } while ((cur != NULL) && (ctxt->error == XPATH_EXPRESSION_OK));
+    patstream = xmlPatternGetStreamCtxt(comp);
+    if (patstream == NULL) {
+        xmlXPathPErrMemory(pctxt);
+	return(-1);
+    }
 
-	goto apply_predicates;
+    eval_all_nodes = xmlStreamWantsAnyNode(patstream);
 
-axis_range_end: /* ----------------------------------------------------- */
-	/*
-	* We have a "/foo[n]", and position() = n was reached.
-	* Note that we can have as well "/foo/::parent::foo[1]", so
-	* a duplicate-aware merge is still needed.
-	* Merge with the result.
-	*/
-	if (outSeq == NULL) {
-	    outSeq = seq;
-	    seq = NULL;
-	} else {
-	    outSeq = mergeAndClear(outSeq, seq);
-            if (outSeq == NULL)
-                xmlXPathPErrMemory(ctxt);
+    if (from_root) {
+	ret = xmlStreamPush(patstream, NULL, NULL);
+	if (ret < 0) {
+	} else if (ret == 1) {
+	    if (toBool)
+		goto return_1;
+	    if (xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval, cur) < 0)
+                xmlXPathPErrMemory(pctxt);
+	}
+    }
+    depth = 0;
+    goto scan_children;
+next_node:
+    do {
+        if (ctxt->opLimit != 0) {
+            if (ctxt->opCount >= ctxt->opLimit) {
+                xmlXPathErr(ctxt, XPATH_RECURSION_LIMIT_EXCEEDED);
+                xmlFreeStreamCtxt(patstream);
+                return(-1);
+            }
+            ctxt->opCount++;
         }
-	/*
-	* Break if only a true/false result was requested.
-	*/
-	if (toBool)
+
+	switch (cur->type) {
+	    case XML_ELEMENT_NODE:
+	    case XML_TEXT_NODE:
+	    case XML_CDATA_SECTION_NODE:
+	    case XML_COMMENT_NODE:
+	    case XML_PI_NODE:
+		if (cur->type == XML_ELEMENT_NODE) {
+		    ret = xmlStreamPush(patstream, cur->name,
+				(cur->ns ? cur->ns->href : NULL));
+		} else if (eval_all_nodes)
+		    ret = xmlStreamPushNode(patstream, NULL, NULL, cur->type);
+		else
+		    break;
+
+		if (ret < 0) {
+		    xmlXPathPErrMemory(pctxt);
+		} else if (ret == 1) {
+		    if (toBool)
+			goto return_1;
+		    if (xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval,
+                                                 cur) < 0)
+                        xmlXPathPErrMemory(pctxt);
+		}
+		if ((cur->children == NULL) || (depth >= max_depth)) {
+		    ret = xmlStreamPop(patstream);
+		    while (cur->next != NULL) {
+			cur = cur->next;
+			if ((cur->type != XML_ENTITY_DECL) &&
+			    (cur->type != XML_DTD_NODE))
+			    goto next_node;
+		    }
+		}
+	    default:
+		break;
+	}
+
+scan_children:
+	if (cur->type == XML_NAMESPACE_DECL) break;
+	if ((cur->children != NULL) && (depth < max_depth)) {
+	    /*
+	     * Do not descend on entities declarations
+	     */
+	    if (cur->children->type != XML_ENTITY_DECL) {
+		cur = cur->children;
+		depth++;
+		/*
+		 * Skip DTDs
+		 */
+		if (cur->type != XML_DTD_NODE)
+		    continue;
+	    }
+	}
+
+	if (cur == limit)
 	    break;
-	continue;
 
-first_hit: /* ---------------------------------------------------------- */
-	/*
-	* Break if only a true/false result was requested and
-	* no predicates existed and a node test succeeded.
-	*/
-	if (outSeq == NULL) {
-	    outSeq = seq;
-	    seq = NULL;
-	} else {
-	    outSeq = mergeAndClear(outSeq, seq);
-            if (outSeq == NULL)
-                xmlXPathPErrMemory(ctxt);
+	while (cur->next != NULL) {
+	    cur = cur->next;
+	    if ((cur->type != XML_ENTITY_DECL) &&
+		(cur->type != XML_DTD_NODE))
+		goto next_node;
+	}
+
+	do {
+	    cur = cur->parent;
+	    depth--;
+	    if ((cur == NULL) || (cur == limit) ||
+                (cur->type == XML_DOCUMENT_NODE))
+	        goto done;
+	    if (cur->type == XML_ELEMENT_NODE) {
+		ret = xmlStreamPop(patstream);
+	    } else if ((eval_all_nodes) &&
+		((cur->type == XML_TEXT_NODE) ||
+		 (cur->type == XML_CDATA_SECTION_NODE) ||
+		 (cur->type == XML_COMMENT_NODE) ||
+		 (cur->type == XML_PI_NODE)))
+	    {
+		ret = xmlStreamPop(patstream);
+	    }
+	    if (cur->next != NULL) {
+		cur = cur->next;
+		break;
+	    }
+	} while (cur != NULL);
+
+    } while ((cur != NULL) && (depth >= 0));
+
+done:
+
+    if (patstream)
+	xmlFreeStreamCtxt(patstream);
+    return(0);
+
+return_1:
+    if (patstream)
+	xmlFreeStreamCtxt(patstream);
+    return(1);
+}
+#endif /* XPATH_STREAMING */
+
+/*
+ * Add the counters of a profiled evaluation to the compiled expression.
+ * Evaluations only read the expression otherwise, so this is the only
+ * place where it is updated after compilation.
+ */
+static void
+xmlXPathMergeProfile(xmlXPathParserContextPtr ctxt) {
+    xmlXPathCompExprPtr comp = ctxt->comp;
+    xmlXPathOpProfile *counters = ctxt->profile;
+    int i;
+
+    xmlMutexLock(&xmlXPathProfileMutex);
+    if (comp->profile == NULL) {
+        comp->profile = counters;
+        ctxt->profile = NULL;
+    } else {
+        for (i = 0; i < comp->nbStep; i++) {
+            comp->profile[i].count += counters[i].count;
+            comp->profile[i].visited += counters[i].visited;
+            comp->profile[i].produced += counters[i].produced;
+            comp->profile[i].time += counters[i].time;
         }
-	break;
+        memset(counters, 0, comp->nbStep * sizeof(counters[0]));
+    }
+    xmlMutexUnlock(&xmlXPathProfileMutex);
+}
 
-apply_predicates: /* --------------------------------------------------- */
-        if (ctxt->error != XPATH_EXPRESSION_OK)
-	    goto error;
+/**
+ * Evaluate the Precompiled XPath expression in the given context.
+ *
+ * @param ctxt  the XPath parser context with the compiled expression
+ * @param toBool  evaluate to a boolean result
+ */
+static int
+xmlXPathRunEval(xmlXPathParserContextPtr ctxt, int toBool)
+{
+    xmlXPathCompExprPtr comp;
+    int oldDepth;
+    int ret = 0;
 
-        /*
-	* Apply predicates.
-	*/
-        if ((predOp != NULL) && (seq->nodeNr > 0)) {
-	    /*
-	    * E.g. when we have a "/foo[some expression][n]".
-	    */
-	    /*
-	    * QUESTION TODO: The old predicate evaluation took into
-	    *  account location-sets.
-	    *  (E.g. ctxt->value->type == XPATH_LOCATIONSET)
-	    *  Do we expect such a set here?
-	    *  All what I learned now from the evaluation semantics
-	    *  does not indicate that a location-set will be processed
-	    *  here, so this looks OK.
-	    */
-	    /*
-	    * Iterate over all predicates, starting with the outermost
-	    * predicate.
-	    * TODO: Problem: we cannot execute the inner predicates first
-	    *  since we cannot go back *up* the operator tree!
-	    *  Options we have:
-	    *  1) Use of recursive functions (like is it currently done
-	    *     via xmlXPathCompOpEval())
-	    *  2) Add a predicate evaluation information stack to the
-	    *     context struct
-	    *  3) Change the way the operators are linked; we need a
-	    *     "parent" field on xmlXPathStepOp
-	    *
-	    * For the moment, I'll try to solve this with a recursive
-	    * function: xmlXPathCompOpEvalPredicate().
-	    */
-	    if (hasPredicateRange != 0)
-		xmlXPathCompOpEvalPredicate(ctxt, predOp, seq, maxPos, maxPos,
-					    hasNsNodes);
-	    else
-		xmlXPathCompOpEvalPredicate(ctxt, predOp, seq, 1, seq->nodeNr,
-					    hasNsNodes);
+    if ((ctxt == NULL) || (ctxt->comp == NULL))
+	return(-1);
+
+    if (ctxt->valueTab == NULL) {
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+        int valueMax = 1;
+#else
+        int valueMax = 10;
+#endif
+
+	/* Allocate the value stack */
+	ctxt->valueTab = xmlMalloc(valueMax * sizeof(xmlXPathObjectPtr));
+	if (ctxt->valueTab == NULL) {
+	    xmlXPathPErrMemory(ctxt);
+	    return(-1);
+	}
+	ctxt->valueNr = 0;
+	ctxt->valueMax = valueMax;
+	ctxt->value = NULL;
+    }
+#ifdef XPATH_STREAMING
+    if (ctxt->comp->stream) {
+	int res;
 
-	    if (ctxt->error != XPATH_EXPRESSION_OK) {
-		total = 0;
-		goto error;
-	    }
-        }
+	if (toBool) {
+	    /*
+	    * Evaluation to boolean result.
+	    */
+	    res = xmlXPathRunStreamEval(ctxt, ctxt->comp->stream, NULL, 1);
+	    if (res != -1)
+		return(res);
+	} else {
+	    xmlXPathObjectPtr resObj = NULL;
 
-        if (seq->nodeNr > 0) {
 	    /*
-	    * Add to result set.
+	    * Evaluation to a sequence.
 	    */
-	    if (outSeq == NULL) {
-		outSeq = seq;
-		seq = NULL;
-	    } else {
-		outSeq = mergeAndClear(outSeq, seq);
-                if (outSeq == NULL)
-                    xmlXPathPErrMemory(ctxt);
-	    }
+	    res = xmlXPathRunStreamEval(ctxt, ctxt->comp->stream, &resObj, 0);
 
-            if (toBool)
-                break;
+	    if ((res != -1) && (resObj != NULL)) {
+		xmlXPathValuePush(ctxt, resObj);
+		return(0);
+	    }
+	    if (resObj != NULL)
+		xmlXPathReleaseObject(ctxt->context, resObj);
 	}
-    }
-
-error:
-    if ((obj->boolval) && (obj->user != NULL)) {
 	/*
-	* QUESTION TODO: What does this do and why?
-	* TODO: Do we have to do this also for the "error"
-	* cleanup further down?
+	* QUESTION TODO: This falls back to normal XPath evaluation
+	* if res == -1. Is this intended?
 	*/
-	ctxt->value->boolval = 1;
-	ctxt->value->user = obj->user;
-	obj->user = NULL;
-	obj->boolval = 0;
     }
-    xmlXPathReleaseObject(xpctxt, obj);
+#endif
+    comp = ctxt->comp;
+    if (comp->last < 0) {
+        xmlXPathErr(ctxt, XPATH_STACK_ERROR);
+	return(-1);
+    }
+    if ((ctxt->context->flags & XML_XPATH_PROFILE) &&
+        (ctxt->profile == NULL)) {
+        size_t size = comp->nbStep * sizeof(xmlXPathOpProfile);
 
-    /*
-    * Ensure we return at least an empty set.
-    */
-    if (outSeq == NULL) {
-	if ((seq != NULL) && (seq->nodeNr == 0)) {
-	    outSeq = seq;
-        } else {
-	    outSeq = xmlXPathNodeSetCreate(NULL);
-            if (outSeq == NULL)
-                xmlXPathPErrMemory(ctxt);
+        ctxt->profile = xmlMalloc(size);
+        if (ctxt->profile == NULL) {
+            xmlXPathPErrMemory(ctxt);
+            return(-1);
         }
+        memset(ctxt->profile, 0, size);
     }
-    if ((seq != NULL) && (seq != outSeq)) {
-	 xmlXPathFreeNodeSet(seq);
-    }
-    /*
-    * Hand over the result. Better to push the set also in
-    * case of errors.
-    */
-    xmlXPathValuePush(ctxt, xmlXPathCacheWrapNodeSet(ctxt, outSeq));
-    /*
-    * Reset the context node.
-    */
-    xpctxt->node = oldContextNode;
-    /*
-    * When traversing the namespace axis in "toBool" mode, it's
-    * possible that tmpNsList wasn't freed.
-    */
-    if (xpctxt->tmpNsList != NULL) {
-        xmlFree(xpctxt->tmpNsList);
-        xpctxt->tmpNsList = NULL;
-    }
+    oldDepth = ctxt->context->depth;
+    if (toBool)
+	ret = xmlXPathCompOpEvalToBoolean(ctxt, &comp->steps[comp->last], 0);
+    else
+	xmlXPathCompOpEval(ctxt, &comp->steps[comp->last]);
+    ctxt->context->depth = oldDepth;
 
-    return(total);
+    if (ctxt->profile != NULL)
+        xmlXPathMergeProfile(ctxt);
+
+    return(ret);
 }
 
-static int
-xmlXPathCompOpEvalFilterFirst(xmlXPathParserContextPtr ctxt,
-			      xmlXPathStepOpPtr op, xmlNodePtr * first);
+/************************************************************************
+ *									*
+ *			Public interfaces				*
+ *									*
+ ************************************************************************/
 
 /**
- * Evaluate the Precompiled XPath operation searching only the first
- * element in document order
+ * Evaluate a predicate result for the current node.
+ * A PredicateExpr is evaluated by evaluating the Expr and converting
+ * the result to a boolean. If the result is a number, the result will
+ * be converted to true if the number is equal to the position of the
+ * context node in the context node list (as returned by the position
+ * function) and will be converted to false otherwise; if the result
+ * is not a number, then the result will be converted as if by a call
+ * to the boolean function.
  *
- * @param ctxt  the XPath parser context with the compiled expression
- * @param op  an XPath compiled operation
- * @param first  the first elem found so far
- * @returns the number of examined objects.
+ * @param ctxt  the XPath context
+ * @param res  the Predicate Expression evaluation result
+ * @returns 1 if predicate is true, 0 otherwise
  */
-static int
-xmlXPathCompOpEvalFirst(xmlXPathParserContextPtr ctxt,
-                        xmlXPathStepOpPtr op, xmlNodePtr * first)
-{
-    int total = 0, cur;
-    xmlXPathCompExprPtr comp;
-    xmlXPathObjectPtr arg1, arg2;
-
-    CHECK_ERROR0;
-    if (OP_LIMIT_EXCEEDED(ctxt, 1))
-        return(0);
-    if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
-        XP_ERROR0(XPATH_RECURSION_LIMIT_EXCEEDED);
-    ctxt->context->depth += 1;
-    comp = ctxt->comp;
-    switch (op->op) {
-        case XPATH_OP_END:
-            break;
-        case XPATH_OP_UNION:
-            total =
-                xmlXPathCompOpEvalFirst(ctxt, &comp->steps[op->ch1],
-                                        first);
-	    CHECK_ERROR0;
-            if ((ctxt->value != NULL)
-                && (ctxt->value->type == XPATH_NODESET)
-                && (ctxt->value->nodesetval != NULL)
-                && (ctxt->value->nodesetval->nodeNr >= 1)) {
-                /*
-                 * limit tree traversing to first node in the result
-                 */
-		/*
-		* OPTIMIZE TODO: This implicitly sorts
-		*  the result, even if not needed. E.g. if the argument
-		*  of the count() function, no sorting is needed.
-		* OPTIMIZE TODO: How do we know if the node-list wasn't
-		*  already sorted?
-		*/
-		if (ctxt->value->nodesetval->nodeNr > 1)
-		    xmlXPathNodeSetSort(ctxt->value->nodesetval);
-                *first = ctxt->value->nodesetval->nodeTab[0];
-            }
-            cur =
-                xmlXPathCompOpEvalFirst(ctxt, &comp->steps[op->ch2],
-                                        first);
-	    CHECK_ERROR0;
-
-            arg2 = xmlXPathValuePop(ctxt);
-            arg1 = xmlXPathValuePop(ctxt);
-            if ((arg1 == NULL) || (arg1->type != XPATH_NODESET) ||
-                (arg2 == NULL) || (arg2->type != XPATH_NODESET)) {
-	        xmlXPathReleaseObject(ctxt->context, arg1);
-	        xmlXPathReleaseObject(ctxt->context, arg2);
-                XP_ERROR0(XPATH_INVALID_TYPE);
-            }
-            if ((ctxt->context->opLimit != 0) &&
-                (((arg1->nodesetval != NULL) &&
-                  (xmlXPathCheckOpLimit(ctxt,
-                                        arg1->nodesetval->nodeNr) < 0)) ||
-                 ((arg2->nodesetval != NULL) &&
-                  (xmlXPathCheckOpLimit(ctxt,
-                                        arg2->nodesetval->nodeNr) < 0)))) {
-	        xmlXPathReleaseObject(ctxt->context, arg1);
-	        xmlXPathReleaseObject(ctxt->context, arg2);
-                break;
-            }
-
-            if ((arg2->nodesetval != NULL) &&
-                (arg2->nodesetval->nodeNr != 0)) {
-                arg1->nodesetval = xmlXPathNodeSetMerge(arg1->nodesetval,
-                                                        arg2->nodesetval);
-                if (arg1->nodesetval == NULL)
-                    xmlXPathPErrMemory(ctxt);
-            }
-            xmlXPathValuePush(ctxt, arg1);
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-            total += cur;
-            break;
-        case XPATH_OP_ROOT:
-            xmlXPathRoot(ctxt);
-            break;
-        case XPATH_OP_NODE:
-            if (op->ch1 != -1)
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            if (op->ch2 != -1)
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    CHECK_ERROR0;
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
-		ctxt->context->node));
-            break;
-        case XPATH_OP_COLLECT:{
-                if (op->ch1 == -1)
-                    break;
-
-                total = xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-		CHECK_ERROR0;
-
-                total += xmlXPathNodeCollectAndTest(ctxt, op, first, NULL, 0);
-                break;
-            }
-        case XPATH_OP_VALUE:
-            xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, op->value4));
-            break;
-        case XPATH_OP_SORT:
-            if (op->ch1 != -1)
-                total +=
-                    xmlXPathCompOpEvalFirst(ctxt, &comp->steps[op->ch1],
-                                            first);
-	    CHECK_ERROR0;
-            if ((ctxt->value != NULL)
-                && (ctxt->value->type == XPATH_NODESET)
-                && (ctxt->value->nodesetval != NULL)
-		&& (ctxt->value->nodesetval->nodeNr > 1))
-                xmlXPathNodeSetSort(ctxt->value->nodesetval);
-            break;
-#ifdef XP_OPTIMIZED_FILTER_FIRST
-	case XPATH_OP_FILTER:
-                total += xmlXPathCompOpEvalFilterFirst(ctxt, op, first);
-            break;
-#endif
+int
+xmlXPathEvalPredicate(xmlXPathContext *ctxt, xmlXPathObject *res) {
+    if ((ctxt == NULL) || (res == NULL)) return(0);
+    switch (res->type) {
+        case XPATH_BOOLEAN:
+	    return(res->boolval);
+        case XPATH_NUMBER:
+	    return(res->floatval == ctxt->proximityPosition);
+        case XPATH_NODESET:
+        case XPATH_XSLT_TREE:
+	    if (res->nodesetval == NULL)
+		return(0);
+	    return(res->nodesetval->nodeNr != 0);
+        case XPATH_STRING:
+	    return((res->stringval != NULL) &&
+	           (xmlStrlen(res->stringval) != 0));
         default:
-            total += xmlXPathCompOpEval(ctxt, op);
-            break;
+	    break;
     }
+    return(0);
+}
 
-    ctxt->context->depth -= 1;
-    return(total);
+/**
+ * Evaluate a predicate result for the current node.
+ * A PredicateExpr is evaluated by evaluating the Expr and converting
+ * the result to a boolean. If the result is a number, the result will
+ * be converted to true if the number is equal to the position of the
+ * context node in the context node list (as returned by the position
+ * function) and will be converted to false otherwise; if the result
+ * is not a number, then the result will be converted as if by a call
+ * to the boolean function.
+ *
+ * @param ctxt  the XPath Parser context
+ * @param res  the Predicate Expression evaluation result
+ * @returns 1 if predicate is true, 0 otherwise
+ */
+int
+xmlXPathEvaluatePredicateResult(xmlXPathParserContext *ctxt,
+                                xmlXPathObject *res) {
+    if ((ctxt == NULL) || (res == NULL)) return(0);
+    switch (res->type) {
+        case XPATH_BOOLEAN:
+	    return(res->boolval);
+        case XPATH_NUMBER:
+#if defined(__BORLANDC__) || (defined(_MSC_VER) && (_MSC_VER == 1200))
+	    return((res->floatval == ctxt->context->proximityPosition) &&
+	           (!xmlXPathIsNaN(res->floatval))); /* MSC pbm Mark Vakoc !*/
+#else
+	    return(res->floatval == ctxt->context->proximityPosition);
+#endif
+        case XPATH_NODESET:
+        case XPATH_XSLT_TREE:
+	    if (res->nodesetval == NULL)
+		return(0);
+	    return(res->nodesetval->nodeNr != 0);
+        case XPATH_STRING:
+	    return((res->stringval != NULL) && (res->stringval[0] != 0));
+        default:
+	    break;
+    }
+    return(0);
 }
 
+#ifdef XPATH_STREAMING
 /**
- * Evaluate the Precompiled XPath operation searching only the last
- * element in document order
+ * Try to compile the XPath expression as a streamable subset.
  *
- * @param ctxt  the XPath parser context with the compiled expression
- * @param op  an XPath compiled operation
- * @param last  the last elem found so far
- * @returns the number of nodes traversed
+ * @param ctxt  an XPath context
+ * @param str  the XPath expression
+ * @returns the compiled expression or NULL if failed to compile.
  */
-static int
-xmlXPathCompOpEvalLast(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op,
-                       xmlNodePtr * last)
-{
-    int total = 0, cur;
+static xmlXPathCompExprPtr
+xmlXPathTryStreamCompile(xmlXPathContextPtr ctxt, const xmlChar *str) {
+    /*
+     * Optimization: use streaming patterns when the XPath expression can
+     * be compiled to a stream lookup
+     */
+    xmlPatternPtr stream;
     xmlXPathCompExprPtr comp;
-    xmlXPathObjectPtr arg1, arg2;
+    xmlDictPtr dict = NULL;
+    const xmlChar **namespaces = NULL;
+    xmlNsPtr ns;
+    int i, j;
 
-    CHECK_ERROR0;
-    if (OP_LIMIT_EXCEEDED(ctxt, 1))
-        return(0);
-    if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
-        XP_ERROR0(XPATH_RECURSION_LIMIT_EXCEEDED);
-    ctxt->context->depth += 1;
-    comp = ctxt->comp;
-    switch (op->op) {
-        case XPATH_OP_END:
-            break;
-        case XPATH_OP_UNION:
-            total =
-                xmlXPathCompOpEvalLast(ctxt, &comp->steps[op->ch1], last);
-	    CHECK_ERROR0;
-            if ((ctxt->value != NULL)
-                && (ctxt->value->type == XPATH_NODESET)
-                && (ctxt->value->nodesetval != NULL)
-                && (ctxt->value->nodesetval->nodeNr >= 1)) {
-                /*
-                 * limit tree traversing to first node in the result
-                 */
-		if (ctxt->value->nodesetval->nodeNr > 1)
-		    xmlXPathNodeSetSort(ctxt->value->nodesetval);
-                *last =
-                    ctxt->value->nodesetval->nodeTab[ctxt->value->
-                                                     nodesetval->nodeNr -
-                                                     1];
-            }
-            cur =
-                xmlXPathCompOpEvalLast(ctxt, &comp->steps[op->ch2], last);
-	    CHECK_ERROR0;
-            if ((ctxt->value != NULL)
-                && (ctxt->value->type == XPATH_NODESET)
-                && (ctxt->value->nodesetval != NULL)
-                && (ctxt->value->nodesetval->nodeNr >= 1)) { /* TODO: NOP ? */
-            }
+    /* Streaming patterns have no operations to profile. */
+    if ((ctxt != NULL) && (ctxt->flags & XML_XPATH_PROFILE))
+        return(NULL);
 
-            arg2 = xmlXPathValuePop(ctxt);
-            arg1 = xmlXPathValuePop(ctxt);
-            if ((arg1 == NULL) || (arg1->type != XPATH_NODESET) ||
-                (arg2 == NULL) || (arg2->type != XPATH_NODESET)) {
-	        xmlXPathReleaseObject(ctxt->context, arg1);
-	        xmlXPathReleaseObject(ctxt->context, arg2);
-                XP_ERROR0(XPATH_INVALID_TYPE);
-            }
-            if ((ctxt->context->opLimit != 0) &&
-                (((arg1->nodesetval != NULL) &&
-                  (xmlXPathCheckOpLimit(ctxt,
-                                        arg1->nodesetval->nodeNr) < 0)) ||
-                 ((arg2->nodesetval != NULL) &&
-                  (xmlXPathCheckOpLimit(ctxt,
-                                        arg2->nodesetval->nodeNr) < 0)))) {
-	        xmlXPathReleaseObject(ctxt->context, arg1);
-	        xmlXPathReleaseObject(ctxt->context, arg2);
-                break;
-            }
+    if ((!xmlStrchr(str, '[')) && (!xmlStrchr(str, '(')) &&
+        (!xmlStrchr(str, '@'))) {
+	const xmlChar *tmp;
+        int res;
 
-            if ((arg2->nodesetval != NULL) &&
-                (arg2->nodesetval->nodeNr != 0)) {
-                arg1->nodesetval = xmlXPathNodeSetMerge(arg1->nodesetval,
-                                                        arg2->nodesetval);
-                if (arg1->nodesetval == NULL)
-                    xmlXPathPErrMemory(ctxt);
-            }
-            xmlXPathValuePush(ctxt, arg1);
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-            total += cur;
-            break;
-        case XPATH_OP_ROOT:
-            xmlXPathRoot(ctxt);
-            break;
-        case XPATH_OP_NODE:
-            if (op->ch1 != -1)
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            if (op->ch2 != -1)
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    CHECK_ERROR0;
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
-		ctxt->context->node));
-            break;
-        case XPATH_OP_COLLECT:{
-                if (op->ch1 == -1)
-                    break;
+	/*
+	 * We don't try to handle expressions using the verbose axis
+	 * specifiers ("::"), just the simplified form at this point.
+	 * Additionally, if there is no list of namespaces available and
+	 *  there's a ":" in the expression, indicating a prefixed QName,
+	 *  then we won't try to compile either. xmlPatterncompile() needs
+	 *  to have a list of namespaces at compilation time in order to
+	 *  compile prefixed name tests.
+	 */
+	tmp = xmlStrchr(str, ':');
+	if ((tmp != NULL) &&
+	    ((ctxt == NULL) || (ctxt->nsNr == 0) || (tmp[1] == ':')))
+	    return(NULL);
 
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-		CHECK_ERROR0;
+	if (ctxt != NULL) {
+	    dict = ctxt->dict;
+	    if (ctxt->nsNr > 0) {
+		namespaces = xmlMalloc(2 * (ctxt->nsNr + 1) * sizeof(xmlChar*));
+		if (namespaces == NULL) {
+		    xmlXPathErrMemory(ctxt);
+		    return(NULL);
+		}
+		for (i = 0, j = 0; (j < ctxt->nsNr); j++) {
+		    ns = ctxt->namespaces[j];
+		    namespaces[i++] = ns->href;
+		    namespaces[i++] = ns->prefix;
+		}
+		namespaces[i++] = NULL;
+		namespaces[i] = NULL;
+	    }
+	}
 
-                total += xmlXPathNodeCollectAndTest(ctxt, op, NULL, last, 0);
-                break;
-            }
-        case XPATH_OP_VALUE:
-            xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, op->value4));
-            break;
-        case XPATH_OP_SORT:
-            if (op->ch1 != -1)
-                total +=
-                    xmlXPathCompOpEvalLast(ctxt, &comp->steps[op->ch1],
-                                           last);
-	    CHECK_ERROR0;
-            if ((ctxt->value != NULL)
-                && (ctxt->value->type == XPATH_NODESET)
-                && (ctxt->value->nodesetval != NULL)
-		&& (ctxt->value->nodesetval->nodeNr > 1))
-                xmlXPathNodeSetSort(ctxt->value->nodesetval);
-            break;
-        default:
-            total += xmlXPathCompOpEval(ctxt, op);
-            break;
+	res = xmlPatternCompileSafe(str, dict, XML_PATTERN_XPATH, namespaces,
+                                    &stream);
+	if (namespaces != NULL) {
+	    xmlFree((xmlChar **)namespaces);
+	}
+        if (res < 0) {
+            xmlXPathErrMemory(ctxt);
+            return(NULL);
+        }
+	if ((stream != NULL) && (xmlPatternStreamable(stream) == 1)) {
+	    comp = xmlXPathNewCompExpr();
+	    if (comp == NULL) {
+		xmlXPathErrMemory(ctxt);
+	        xmlFreePattern(stream);
+		return(NULL);
+	    }
+	    comp->stream = stream;
+	    comp->dict = dict;
+	    if (comp->dict)
+		xmlDictReference(comp->dict);
+	    return(comp);
+	}
+	xmlFreePattern(stream);
     }
-
-    ctxt->context->depth -= 1;
-    return (total);
+    return(NULL);
 }
+#endif /* XPATH_STREAMING */
 
-#ifdef XP_OPTIMIZED_FILTER_FIRST
-static int
-xmlXPathCompOpEvalFilterFirst(xmlXPathParserContextPtr ctxt,
-			      xmlXPathStepOpPtr op, xmlNodePtr * first)
-{
-    int total = 0;
-    xmlXPathCompExprPtr comp;
-    xmlXPathObjectPtr obj;
-    xmlNodeSetPtr set;
+static void
+xmlXPathOptimizeExpression(xmlXPathParserContextPtr pctxt,
+                           xmlXPathStepOpPtr op)
+{
+    xmlXPathCompExprPtr comp = pctxt->comp;
+    xmlXPathContextPtr ctxt;
 
-    CHECK_ERROR0;
-    comp = ctxt->comp;
     /*
-    * Optimization for ()[last()] selection i.e. the last elem
+    * Try to rewrite "descendant-or-self::node()/foo" to an optimized
+    * internal representation. This is also possible if "foo" has an
+    * "[@name = value]" predicate which doesn't depend on the position.
     */
-    if ((op->ch1 != -1) && (op->ch2 != -1) &&
-	(comp->steps[op->ch1].op == XPATH_OP_SORT) &&
-	(comp->steps[op->ch2].op == XPATH_OP_SORT)) {
-	int f = comp->steps[op->ch2].ch1;
 
-	if ((f != -1) &&
-	    (comp->steps[f].op == XPATH_OP_FUNCTION) &&
-	    (comp->steps[f].value5 == NULL) &&
-	    (comp->steps[f].value == 0) &&
-	    (comp->steps[f].value4 != NULL) &&
-	    (xmlStrEqual
-	    (comp->steps[f].value4, BAD_CAST "last"))) {
-	    xmlNodePtr last = NULL;
+    if ((op->op == XPATH_OP_COLLECT /* 11 */) &&
+        (op->ch1 != -1) &&
+        ((op->ch2 == -1 /* no predicate */) ||
+         (xmlXPathIsAttrValuePredicate(comp, &comp->steps[op->ch2]))))
+    {
+        xmlXPathStepOpPtr prevop = &comp->steps[op->ch1];
 
-	    total +=
-		xmlXPathCompOpEvalLast(ctxt,
-		    &comp->steps[op->ch1],
-		    &last);
-	    CHECK_ERROR0;
-	    /*
-	    * The nodeset should be in document order,
-	    * Keep only the last value
-	    */
-	    if ((ctxt->value != NULL) &&
-		(ctxt->value->type == XPATH_NODESET) &&
-		(ctxt->value->nodesetval != NULL) &&
-		(ctxt->value->nodesetval->nodeTab != NULL) &&
-		(ctxt->value->nodesetval->nodeNr > 1)) {
-                xmlXPathNodeSetKeepLast(ctxt->value->nodesetval);
-		*first = *(ctxt->value->nodesetval->nodeTab);
-	    }
-	    return (total);
+        if ((prevop->op == XPATH_OP_COLLECT /* 11 */) &&
+            ((xmlXPathAxisVal) prevop->value ==
+                AXIS_DESCENDANT_OR_SELF) &&
+            (prevop->ch2 == -1) &&
+            ((xmlXPathTestVal) prevop->value2 == NODE_TEST_TYPE) &&
+            ((xmlXPathTypeVal) prevop->value3 == NODE_TYPE_NODE))
+        {
+            /*
+            * This is a "descendant-or-self::node()" without predicates.
+            * Try to eliminate it.
+            */
+
+            switch ((xmlXPathAxisVal) op->value) {
+                case AXIS_CHILD:
+                case AXIS_DESCENDANT:
+                    /*
+                    * Convert "descendant-or-self::node()/child::" or
+                    * "descendant-or-self::node()/descendant::" to
+                    * "descendant::"
+                    */
+                    op->ch1   = prevop->ch1;
+                    op->value = AXIS_DESCENDANT;
+                    break;
+                case AXIS_SELF:
+                case AXIS_DESCENDANT_OR_SELF:
+                    /*
+                    * Convert "descendant-or-self::node()/self::" or
+                    * "descendant-or-self::node()/descendant-or-self::" to
+                    * to "descendant-or-self::"
+                    */
+                    op->ch1   = prevop->ch1;
+                    op->value = AXIS_DESCENDANT_OR_SELF;
+                    break;
+                default:
+                    break;
+            }
 	}
     }
 
-    if (op->ch1 != -1)
-	total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-    CHECK_ERROR0;
-    if (op->ch2 == -1)
-	return (total);
-    if (ctxt->value == NULL)
-	return (total);
-
     /*
-     * In case of errors, xmlXPathNodeSetFilter can pop additional nodes from
-     * the stack. We have to temporarily remove the nodeset object from the
-     * stack to avoid freeing it prematurely.
-     */
-    CHECK_TYPE0(XPATH_NODESET);
-    obj = xmlXPathValuePop(ctxt);
-    set = obj->nodesetval;
-    if (set != NULL) {
-        xmlXPathNodeSetFilter(ctxt, set, op->ch2, 1, 1, 1);
-        if (set->nodeNr > 0)
-            *first = set->nodeTab[0];
+    * Select a specialized evaluator for simple steps.
+    */
+    if ((op->op == XPATH_OP_COLLECT) && (op->ch2 == -1)) {
+        xmlXPathAxisVal axis = (xmlXPathAxisVal) op->value;
+        xmlXPathTestVal test = (xmlXPathTestVal) op->value2;
+        xmlXPathTypeVal type = (xmlXPathTypeVal) op->value3;
+
+        if ((test == NODE_TEST_NAME) && (type == NODE_TYPE_NODE) &&
+            (op->value5 != NULL)) {
+            if (axis == AXIS_CHILD)
+                op->fast = XPATH_FAST_CHILD_NAME;
+            else if (axis == AXIS_ATTRIBUTE)
+                op->fast = XPATH_FAST_ATTRIBUTE_NAME;
+            else if (axis == AXIS_DESCENDANT)
+                op->fast = XPATH_FAST_DESCENDANT_NAME;
+        } else if ((test == NODE_TEST_TYPE) && (type == NODE_TYPE_TEXT) &&
+                   (axis == AXIS_CHILD)) {
+            op->fast = XPATH_FAST_CHILD_TEXT;
+        }
     }
-    xmlXPathValuePush(ctxt, obj);
 
-    return (total);
+    /* OP_VALUE has invalid ch1. */
+    if (op->op == XPATH_OP_VALUE)
+        return;
+
+    /* Recurse */
+    ctxt = pctxt->context;
+    if (ctxt != NULL) {
+        if (ctxt->depth >= XPATH_MAX_RECURSION_DEPTH)
+            return;
+        ctxt->depth += 1;
+    }
+    if (op->ch1 != -1)
+        xmlXPathOptimizeExpression(pctxt, &comp->steps[op->ch1]);
+    if (op->ch2 != -1)
+	xmlXPathOptimizeExpression(pctxt, &comp->steps[op->ch2]);
+    if (ctxt != NULL)
+        ctxt->depth -= 1;
 }
-#endif /* XP_OPTIMIZED_FILTER_FIRST */
 
-/**
- * Evaluate the Precompiled XPath operation
- *
- * @param ctxt  the XPath parser context with the compiled expression
- * @param op  an XPath compiled operation
- * @returns the number of nodes traversed
+/*
+ * Flags of subexpressions computed by xmlXPathOptimizeCompExpr
  */
-static int
-xmlXPathCompOpEval(xmlXPathParserContextPtr ctxt, xmlXPathStepOpPtr op)
-{
-    int total = 0;
-    int equal, ret;
-    xmlXPathCompExprPtr comp;
-    xmlXPathObjectPtr arg1, arg2;
+#define XP_EXPR_PURE		(1 << 0) /* only standard functions */
+#define XP_EXPR_INVARIANT	(1 << 1) /* independent of the context node */
+#define XP_EXPR_CONSTANT	(1 << 2) /* a literal value */
 
-    CHECK_ERROR0;
-    if (OP_LIMIT_EXCEEDED(ctxt, 1))
-        return(0);
-    if (ctxt->context->depth >= XPATH_MAX_RECURSION_DEPTH)
-        XP_ERROR0(XPATH_RECURSION_LIMIT_EXCEEDED);
-    ctxt->context->depth += 1;
-    comp = ctxt->comp;
-    switch (op->op) {
-        case XPATH_OP_END:
-            break;
-        case XPATH_OP_AND:
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            xmlXPathBooleanFunction(ctxt, 1);
-            if ((ctxt->value == NULL) || (ctxt->value->boolval == 0))
-                break;
-            arg2 = xmlXPathValuePop(ctxt);
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    if (ctxt->error) {
-		xmlXPathFreeObject(arg2);
-		break;
-	    }
-            xmlXPathBooleanFunction(ctxt, 1);
-            if (ctxt->value != NULL)
-                ctxt->value->boolval &= arg2->boolval;
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-            break;
-        case XPATH_OP_OR:
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            xmlXPathBooleanFunction(ctxt, 1);
-            if ((ctxt->value == NULL) || (ctxt->value->boolval == 1))
-                break;
-            arg2 = xmlXPathValuePop(ctxt);
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    if (ctxt->error) {
-		xmlXPathFreeObject(arg2);
-		break;
-	    }
-            xmlXPathBooleanFunction(ctxt, 1);
-            if (ctxt->value != NULL)
-                ctxt->value->boolval |= arg2->boolval;
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-            break;
-        case XPATH_OP_EQUAL:
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    CHECK_ERROR0;
-	    if (op->value)
-		equal = xmlXPathEqualValues(ctxt);
-	    else
-		equal = xmlXPathNotEqualValues(ctxt);
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, equal));
-            break;
-        case XPATH_OP_CMP:
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    CHECK_ERROR0;
-            ret = xmlXPathCompareValues(ctxt, op->value, op->value2);
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewBoolean(ctxt, ret));
-            break;
-        case XPATH_OP_PLUS:
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            if (op->ch2 != -1) {
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    }
-	    CHECK_ERROR0;
-            if (op->value == 0)
-                xmlXPathSubValues(ctxt);
-            else if (op->value == 1)
-                xmlXPathAddValues(ctxt);
-            else if (op->value == 2)
-                xmlXPathValueFlipSign(ctxt);
-            else if (op->value == 3) {
-                CAST_TO_NUMBER;
-                CHECK_TYPE0(XPATH_NUMBER);
-            }
-            break;
-        case XPATH_OP_MULT:
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    CHECK_ERROR0;
-            if (op->value == 0)
-                xmlXPathMultValues(ctxt);
-            else if (op->value == 1)
-                xmlXPathDivValues(ctxt);
-            else if (op->value == 2)
-                xmlXPathModValues(ctxt);
-            break;
-        case XPATH_OP_UNION:
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    CHECK_ERROR0;
+/*
+ * Standard functions which can be evaluated at compile time if all
+ * arguments are literals.
+ */
+static const struct {
+    const char *name;
+    int minArgs;
+    int maxArgs;
+} xmlXPathFoldableFunctions[] = {
+    { "boolean", 1, 1 },
+    { "ceiling", 1, 1 },
+    { "concat", 2, INT_MAX },
+    { "contains", 2, 2 },
+    { "false", 0, 0 },
+    { "floor", 1, 1 },
+    { "normalize-space", 1, 1 },
+    { "not", 1, 1 },
+    { "number", 1, 1 },
+    { "round", 1, 1 },
+    { "starts-with", 2, 2 },
+    { "string", 1, 1 },
+    { "string-length", 1, 1 },
+    { "substring", 2, 3 },
+    { "substring-after", 2, 2 },
+    { "substring-before", 2, 2 },
+    { "translate", 3, 3 },
+    { "true", 0, 0 }
+};
 
-            arg2 = xmlXPathValuePop(ctxt);
-            arg1 = xmlXPathValuePop(ctxt);
-            if ((arg1 == NULL) || (arg1->type != XPATH_NODESET) ||
-                (arg2 == NULL) || (arg2->type != XPATH_NODESET)) {
-	        xmlXPathReleaseObject(ctxt->context, arg1);
-	        xmlXPathReleaseObject(ctxt->context, arg2);
-                XP_ERROR0(XPATH_INVALID_TYPE);
-            }
-            if ((ctxt->context->opLimit != 0) &&
-                (((arg1->nodesetval != NULL) &&
-                  (xmlXPathCheckOpLimit(ctxt,
-                                        arg1->nodesetval->nodeNr) < 0)) ||
-                 ((arg2->nodesetval != NULL) &&
-                  (xmlXPathCheckOpLimit(ctxt,
-                                        arg2->nodesetval->nodeNr) < 0)))) {
-	        xmlXPathReleaseObject(ctxt->context, arg1);
-	        xmlXPathReleaseObject(ctxt->context, arg2);
-                break;
-            }
+static int
+xmlXPathIsStandardFunction(xmlXPathStepOpPtr op, const char *name) {
+    return((op->op == XPATH_OP_FUNCTION) && (op->value5 == NULL) &&
+           (op->value4 != NULL) && (xmlStrEqual(op->value4, BAD_CAST name)));
+}
 
-	    if (((arg2->nodesetval != NULL) &&
-		 (arg2->nodesetval->nodeNr != 0)))
-	    {
-		arg1->nodesetval = xmlXPathNodeSetMerge(arg1->nodesetval,
-							arg2->nodesetval);
-                if (arg1->nodesetval == NULL)
-                    xmlXPathPErrMemory(ctxt);
-	    }
+static int
+xmlXPathIsFoldableFunction(xmlXPathStepOpPtr op) {
+    size_t i;
 
-            xmlXPathValuePush(ctxt, arg1);
-	    xmlXPathReleaseObject(ctxt->context, arg2);
-            break;
-        case XPATH_OP_ROOT:
-            xmlXPathRoot(ctxt);
-            break;
-        case XPATH_OP_NODE:
-            if (op->ch1 != -1)
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            if (op->ch2 != -1)
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	    CHECK_ERROR0;
-	    xmlXPathValuePush(ctxt, xmlXPathCacheNewNodeSet(ctxt,
-                                                    ctxt->context->node));
-            break;
-        case XPATH_OP_COLLECT:{
-                if (op->ch1 == -1)
-                    break;
+    if ((op->value5 != NULL) || (op->value4 == NULL))
+        return(0);
+    for (i = 0; i < sizeof(xmlXPathFoldableFunctions) /
+                    sizeof(xmlXPathFoldableFunctions[0]); i++) {
+        if (xmlStrEqual(op->value4,
+                        BAD_CAST xmlXPathFoldableFunctions[i].name))
+            return((op->value >= xmlXPathFoldableFunctions[i].minArgs) &&
+                   (op->value <= xmlXPathFoldableFunctions[i].maxArgs));
+    }
 
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-		CHECK_ERROR0;
+    return(0);
+}
 
-                total += xmlXPathNodeCollectAndTest(ctxt, op, NULL, NULL, 0);
-                break;
-            }
-        case XPATH_OP_VALUE:
-            xmlXPathValuePush(ctxt, xmlXPathCacheObjectCopy(ctxt, op->value4));
+/*
+ * Compute the flags of a function call from the flags of its
+ * arguments.
+ */
+static int
+xmlXPathFunctionFlags(xmlXPathStepOpPtr op, int argFlags) {
+    static const char *const contextFuncs[] = {
+        "last", "position", "lang"
+    };
+    static const char *const contextDefaultFuncs[] = {
+        "local-name", "name", "namespace-uri", "normalize-space",
+        "number", "string", "string-length"
+    };
+    size_t i;
+
+    if ((op->value5 != NULL) || (op->value4 == NULL))
+        return(0);
+    for (i = 0; i < NUM_STANDARD_FUNCTIONS; i++) {
+        if (xmlStrEqual(op->value4,
+                        BAD_CAST xmlXPathStandardFunctions[i].name))
             break;
-        case XPATH_OP_VARIABLE:{
-		xmlXPathObjectPtr val;
+    }
+    if (i >= NUM_STANDARD_FUNCTIONS)
+        return(0);
 
-                if (op->ch1 != -1)
-                    total +=
-                        xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-                if (op->value5 == NULL) {
-		    val = xmlXPathVariableLookup(ctxt->context, op->value4);
-		    if (val == NULL) {
-                        xmlXPathErrFmt(ctxt, XPATH_UNDEF_VARIABLE_ERROR,
-                                       "Undefined variable: %s\n", op->value4);
-                        return 0;
-                    }
-                    xmlXPathValuePush(ctxt, val);
-		} else {
-                    const xmlChar *URI;
+    argFlags &= XP_EXPR_PURE | XP_EXPR_INVARIANT;
+    for (i = 0; i < sizeof(contextFuncs) / sizeof(contextFuncs[0]); i++) {
+        if (xmlStrEqual(op->value4, BAD_CAST contextFuncs[i]))
+            return(argFlags & XP_EXPR_PURE);
+    }
+    if (op->value == 0) {
+        for (i = 0;
+             i < sizeof(contextDefaultFuncs) / sizeof(contextDefaultFuncs[0]);
+             i++) {
+            if (xmlStrEqual(op->value4, BAD_CAST contextDefaultFuncs[i]))
+                return(argFlags & XP_EXPR_PURE);
+        }
+    }
 
-                    URI = xmlXPathNsLookup(ctxt->context, op->value5);
-                    if (URI == NULL) {
-                        xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
-                                       "Undefined namespace prefix: %s\n",
-                                       op->value5);
-                        return 0;
-                    }
-		    val = xmlXPathVariableLookupNS(ctxt->context,
-                                                       op->value4, URI);
-		    if (val == NULL) {
-                        xmlXPathErrFmt(ctxt, XPATH_UNDEF_VARIABLE_ERROR,
-                                       "Undefined variable: %s:%s\n",
-                                       op->value5, op->value4);
-                        return 0;
-                    }
-                    xmlXPathValuePush(ctxt, val);
-                }
-                break;
-            }
-        case XPATH_OP_FUNCTION:{
-                xmlXPathFunction func;
-                const xmlChar *oldFunc, *oldFuncURI;
-		int i;
-                int frame;
+    return(argFlags);
+}
 
-                frame = ctxt->valueNr;
-                if (op->ch1 != -1) {
-                    total +=
-                        xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-                    if (ctxt->error != XPATH_EXPRESSION_OK)
-                        break;
-                }
-		if (ctxt->valueNr < frame + op->value)
-		    XP_ERROR0(XPATH_INVALID_OPERAND);
-		for (i = 0; i < op->value; i++) {
-		    if (ctxt->valueTab[(ctxt->valueNr - 1) - i] == NULL)
-			XP_ERROR0(XPATH_INVALID_OPERAND);
-                }
-                if (op->cache != NULL)
-                    func = op->cache;
-                else {
-                    const xmlChar *URI = NULL;
+/*
+ * Replace an operation with a literal value.
+ */
+static void
+xmlXPathOpSetValue(xmlXPathCompExprPtr comp, xmlXPathStepOpPtr op,
+                   xmlXPathObjectPtr value) {
+    if (op->op == XPATH_OP_VALUE) {
+        xmlXPathFreeObject(op->value4);
+    } else if (comp->dict == NULL) {
+        xmlFree(op->value4);
+        xmlFree(op->value5);
+    }
+
+    op->op = XPATH_OP_VALUE;
+    op->ch1 = -1;
+    op->ch2 = -1;
+    op->value = value->type;
+    op->value2 = 0;
+    op->value3 = 0;
+    op->value4 = value;
+    op->value5 = NULL;
+    op->cache = NULL;
+    op->fast = XPATH_FAST_NONE;
+}
 
-                    if (op->value5 == NULL) {
-                        func = xmlXPathFunctionLookup(ctxt->context,
-                                                      op->value4);
-                        if (func == NULL) {
-                            xmlXPathErrFmt(ctxt, XPATH_UNKNOWN_FUNC_ERROR,
-                                           "Unregistered function: %s\n",
-                                           op->value4);
-                            return 0;
-                        }
-                    } else {
-                        URI = xmlXPathNsLookup(ctxt->context, op->value5);
-                        if (URI == NULL) {
-                            xmlXPathErrFmt(ctxt, XPATH_UNDEF_PREFIX_ERROR,
-                                           "Undefined namespace prefix: %s\n",
-                                           op->value5);
-                            return 0;
-                        }
-                        func = xmlXPathFunctionLookupNS(ctxt->context,
-                                                        op->value4, URI);
-                        if (func == NULL) {
-                            xmlXPathErrFmt(ctxt, XPATH_UNKNOWN_FUNC_ERROR,
-                                           "Unregistered function: %s:%s\n",
-                                           op->value5, op->value4);
-                            return 0;
-                        }
-                    }
-                    op->cache = func;
-                    op->cacheURI = (void *) URI;
-                }
-                oldFunc = ctxt->context->function;
-                oldFuncURI = ctxt->context->functionURI;
-                ctxt->context->function = op->value4;
-                ctxt->context->functionURI = op->cacheURI;
-                func(ctxt, op->value);
-                ctxt->context->function = oldFunc;
-                ctxt->context->functionURI = oldFuncURI;
-                if ((ctxt->error == XPATH_EXPRESSION_OK) &&
-                    (ctxt->valueNr != frame + 1))
-                    XP_ERROR0(XPATH_STACK_ERROR);
-                break;
-            }
-        case XPATH_OP_ARG:
-            if (op->ch1 != -1) {
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	        CHECK_ERROR0;
-            }
-            if (op->ch2 != -1) {
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch2]);
-	        CHECK_ERROR0;
-	    }
-            break;
-        case XPATH_OP_PREDICATE:
-        case XPATH_OP_FILTER:{
-                xmlXPathObjectPtr obj;
-                xmlNodeSetPtr set;
+/*
+ * Evaluate an operation with literal operands at compile time.
+ */
+static void
+xmlXPathFoldOp(xmlXPathParserContextPtr pctxt, xmlXPathStepOpPtr op) {
+    int valueNr = pctxt->valueNr;
+    xmlXPathObjectPtr value;
 
-                /*
-                 * Optimization for ()[1] selection i.e. the first elem
-                 */
-                if ((op->ch1 != -1) && (op->ch2 != -1) &&
-#ifdef XP_OPTIMIZED_FILTER_FIRST
-		    /*
-		    * FILTER TODO: Can we assume that the inner processing
-		    *  will result in an ordered list if we have an
-		    *  XPATH_OP_FILTER?
-		    *  What about an additional field or flag on
-		    *  xmlXPathObject like @sorted ? This way we wouldn't need
-		    *  to assume anything, so it would be more robust and
-		    *  easier to optimize.
-		    */
-                    ((comp->steps[op->ch1].op == XPATH_OP_SORT) || /* 18 */
-		     (comp->steps[op->ch1].op == XPATH_OP_FILTER)) && /* 17 */
-#else
-		    (comp->steps[op->ch1].op == XPATH_OP_SORT) &&
-#endif
-                    (comp->steps[op->ch2].op == XPATH_OP_VALUE)) { /* 12 */
-                    xmlXPathObjectPtr val;
+    if ((pctxt->context == NULL) || (pctxt->error != XPATH_EXPRESSION_OK))
+        return;
+
+    xmlXPathCompOpEval(pctxt, op);
+    if ((pctxt->error != XPATH_EXPRESSION_OK) ||
+        (pctxt->valueNr != valueNr + 1))
+        return;
+
+    value = xmlXPathValuePop(pctxt);
+    if (value != NULL)
+        xmlXPathOpSetValue(pctxt->comp, op, value);
+}
+
+/*
+ * Check for "count(x)" where x is a location path.
+ */
+static int
+xmlXPathIsCountOfPath(xmlXPathCompExprPtr comp, int index) {
+    xmlXPathStepOpPtr op, argOp, pathOp;
+
+    op = &comp->steps[index];
+    if ((!xmlXPathIsStandardFunction(op, "count")) || (op->value != 1) ||
+        (op->ch1 < 0))
+        return(0);
+    argOp = &comp->steps[op->ch1];
+    if ((argOp->op != XPATH_OP_ARG) || (argOp->ch1 != -1) || (argOp->ch2 < 0))
+        return(0);
+    pathOp = &comp->steps[argOp->ch2];
+    if ((pathOp->op == XPATH_OP_SORT) && (pathOp->ch1 >= 0))
+        pathOp = &comp->steps[pathOp->ch1];
+
+    return(pathOp->op == XPATH_OP_COLLECT);
+}
+
+static int
+xmlXPathIsNumber(xmlXPathCompExprPtr comp, int index, double val) {
+    xmlXPathStepOpPtr op = &comp->steps[index];
+    xmlXPathObjectPtr obj = op->value4;
+
+    return((op->op == XPATH_OP_VALUE) && (obj != NULL) &&
+           (obj->type == XPATH_NUMBER) && (obj->floatval == val));
+}
+
+/*
+ * Check for comparisons of count() with zero which are true for
+ * any non-empty node-set: "count(x) > 0", "count(x) >= 1" and
+ * "count(x) != 0", with the operands in any order.
+ */
+static int
+xmlXPathIsExistsTest(xmlXPathCompExprPtr comp, xmlXPathStepOpPtr op) {
+    int valueIdx, countFirst;
+
+    if (((op->op != XPATH_OP_CMP) && (op->op != XPATH_OP_EQUAL)) ||
+        (op->ch1 < 0) || (op->ch2 < 0))
+        return(0);
+
+    if (xmlXPathIsCountOfPath(comp, op->ch1)) {
+        valueIdx = op->ch2;
+        countFirst = 1;
+    } else if (xmlXPathIsCountOfPath(comp, op->ch2)) {
+        valueIdx = op->ch1;
+        countFirst = 0;
+    } else {
+        return(0);
+    }
+
+    if (op->op == XPATH_OP_EQUAL)
+        return((op->value == 0) && (xmlXPathIsNumber(comp, valueIdx, 0)));
+
+    /* value is "inf", value2 is "strict" */
+    if ((op->value != 0) == countFirst)
+        return(0);
+    if (op->value2)
+        return(xmlXPathIsNumber(comp, valueIdx, 0));
+    return(xmlXPathIsNumber(comp, valueIdx, 1));
+}
+
+/*
+ * Check for "position() = last()" or "last()".
+ */
+static int
+xmlXPathIsLastTest(xmlXPathCompExprPtr comp, xmlXPathStepOpPtr op) {
+    xmlXPathStepOpPtr op1, op2;
+
+    if ((op->op == XPATH_OP_SORT) && (op->ch1 >= 0))
+        op = &comp->steps[op->ch1];
+    if (xmlXPathIsStandardFunction(op, "last"))
+        return(op->value == 0);
+    if ((op->op != XPATH_OP_EQUAL) || (op->value != 1))
+        return(0);
+
+    op1 = &comp->steps[op->ch1];
+    op2 = &comp->steps[op->ch2];
+    if (xmlXPathIsStandardFunction(op1, "last")) {
+        xmlXPathStepOpPtr tmp = op1;
+
+        op1 = op2;
+        op2 = tmp;
+    }
+
+    return((xmlXPathIsStandardFunction(op1, "position")) &&
+           (op1->value == 0) &&
+           (xmlXPathIsStandardFunction(op2, "last")) &&
+           (op2->value == 0));
+}
+
+/*
+ * Assign invariant slots to maximal context independent
+ * subexpressions of predicates which are worth caching.
+ */
+static void
+xmlXPathMarkInvariants(xmlXPathParserContextPtr pctxt, const int *flags,
+                       int index, int inPredicate) {
+    xmlXPathCompExprPtr comp = pctxt->comp;
+    xmlXPathStepOpPtr op = &comp->steps[index];
+    xmlXPathContextPtr ctxt = pctxt->context;
+
+    if ((inPredicate) && (flags[index] & XP_EXPR_INVARIANT)) {
+        if ((op->op != XPATH_OP_VALUE) && (op->op != XPATH_OP_VARIABLE) &&
+            (op->op != XPATH_OP_ROOT))
+            op->invariant = ++comp->nbInvariant;
+        return;
+    }
+
+    if (op->op == XPATH_OP_VALUE)
+        return;
+
+    if (ctxt != NULL) {
+        if (ctxt->depth >= XPATH_MAX_RECURSION_DEPTH)
+            return;
+        ctxt->depth += 1;
+    }
+    if (op->ch1 != -1)
+        xmlXPathMarkInvariants(pctxt, flags, op->ch1, inPredicate);
+    if (op->ch2 != -1)
+        xmlXPathMarkInvariants(pctxt, flags, op->ch2,
+                               inPredicate ||
+                               (op->op == XPATH_OP_COLLECT) ||
+                               (op->op == XPATH_OP_PREDICATE) ||
+                               (op->op == XPATH_OP_FILTER));
+    if (ctxt != NULL)
+        ctxt->depth -= 1;
+}
+
+/**
+ * Optimize a compiled expression:
+ *
+ * - Operations with literal operands are evaluated at compile time.
+ * - Comparisons of count() with zero become existence tests.
+ * - "[position() = last()]" predicates only keep the last node.
+ * - Context independent subexpressions of predicates are evaluated
+ *   once per evaluation of the whole expression.
+ * - The peephole rewrites of xmlXPathOptimizeExpression are applied.
+ *
+ * Operations are added after their operands, so a forward pass over
+ * the steps sees the operands first.
+ *
+ * @param pctxt  the XPath parser context with the compiled expression
+ */
+static void
+xmlXPathOptimizeCompExpr(xmlXPathParserContextPtr pctxt) {
+    xmlXPathCompExprPtr comp = pctxt->comp;
+    int *flags;
+    int i;
 
-                    val = comp->steps[op->ch2].value4;
-                    if ((val != NULL) && (val->type == XPATH_NUMBER) &&
-                        (val->floatval == 1.0)) {
-                        xmlNodePtr first = NULL;
+    if ((comp->nbStep <= 1) || (comp->last < 0))
+        return;
 
-                        total +=
-                            xmlXPathCompOpEvalFirst(ctxt,
-                                                    &comp->steps[op->ch1],
-                                                    &first);
-			CHECK_ERROR0;
-                        /*
-                         * The nodeset should be in document order,
-                         * Keep only the first value
-                         */
-                        if ((ctxt->value != NULL) &&
-                            (ctxt->value->type == XPATH_NODESET) &&
-                            (ctxt->value->nodesetval != NULL) &&
-                            (ctxt->value->nodesetval->nodeNr > 1))
-                            xmlXPathNodeSetClearFromPos(ctxt->value->nodesetval,
-                                                        1, 1);
-                        break;
-                    }
-                }
-                /*
-                 * Optimization for ()[last()] selection i.e. the last elem
-                 */
-                if ((op->ch1 != -1) && (op->ch2 != -1) &&
-                    (comp->steps[op->ch1].op == XPATH_OP_SORT) &&
-                    (comp->steps[op->ch2].op == XPATH_OP_SORT)) {
-                    int f = comp->steps[op->ch2].ch1;
+    flags = xmlMalloc(comp->nbStep * sizeof(flags[0]));
+    if (flags == NULL) {
+        xmlXPathPErrMemory(pctxt);
+        return;
+    }
 
-                    if ((f != -1) &&
-                        (comp->steps[f].op == XPATH_OP_FUNCTION) &&
-                        (comp->steps[f].value5 == NULL) &&
-                        (comp->steps[f].value == 0) &&
-                        (comp->steps[f].value4 != NULL) &&
-                        (xmlStrEqual
-                         (comp->steps[f].value4, BAD_CAST "last"))) {
-                        xmlNodePtr last = NULL;
+    for (i = 0; i < comp->nbStep; i++) {
+        xmlXPathStepOpPtr op = &comp->steps[i];
+        int f1, f2, f;
 
-                        total +=
-                            xmlXPathCompOpEvalLast(ctxt,
-                                                   &comp->steps[op->ch1],
-                                                   &last);
-			CHECK_ERROR0;
-                        /*
-                         * The nodeset should be in document order,
-                         * Keep only the last value
-                         */
-                        if ((ctxt->value != NULL) &&
-                            (ctxt->value->type == XPATH_NODESET) &&
-                            (ctxt->value->nodesetval != NULL) &&
-                            (ctxt->value->nodesetval->nodeTab != NULL) &&
-                            (ctxt->value->nodesetval->nodeNr > 1))
-                            xmlXPathNodeSetKeepLast(ctxt->value->nodesetval);
+        if ((op->ch1 >= i) || (op->ch2 >= i)) {
+            flags[i] = 0;
+            continue;
+        }
+        f1 = (op->ch1 >= 0) ? flags[op->ch1] : -1;
+        f2 = (op->ch2 >= 0) ? flags[op->ch2] : -1;
+        f = f1 & f2;
+
+        switch (op->op) {
+            case XPATH_OP_VALUE:
+                f = XP_EXPR_PURE | XP_EXPR_INVARIANT | XP_EXPR_CONSTANT;
+                break;
+            case XPATH_OP_VARIABLE:
+            case XPATH_OP_ROOT:
+                f = XP_EXPR_PURE | XP_EXPR_INVARIANT;
+                break;
+            case XPATH_OP_NODE:
+                f = XP_EXPR_PURE;
+                break;
+            case XPATH_OP_COLLECT:
+            case XPATH_OP_FILTER:
+                /* Predicates are evaluated relative to the selected nodes */
+                if (op->ch1 < 0)
+                    f1 = 0;
+                f = f1 & ((f2 & XP_EXPR_PURE) ? -1 : 0);
+                f &= XP_EXPR_PURE | XP_EXPR_INVARIANT;
+                break;
+            case XPATH_OP_PREDICATE:
+                f &= XP_EXPR_PURE;
+                break;
+            case XPATH_OP_FUNCTION:
+                f = xmlXPathFunctionFlags(op, f1);
+                if ((f1 & XP_EXPR_CONSTANT) &&
+                    (xmlXPathIsFoldableFunction(op))) {
+                    xmlXPathFoldOp(pctxt, op);
+                    if (op->op == XPATH_OP_VALUE)
+                        f |= XP_EXPR_CONSTANT;
+                }
+                break;
+            case XPATH_OP_ARG:
+                break;
+            case XPATH_OP_SORT:
+                if (f1 & XP_EXPR_CONSTANT) {
+                    /* Sorting a literal has no effect */
+                    xmlXPathObjectPtr value;
+
+                    value = xmlXPathObjectCopy(comp->steps[op->ch1].value4);
+                    if (value == NULL) {
+                        xmlXPathPErrMemory(pctxt);
                         break;
                     }
+                    xmlXPathOpSetValue(comp, op, value);
                 }
-		/*
-		* Process inner predicates first.
-		* Example "index[parent::book][1]":
-		* ...
-		*   PREDICATE   <-- we are here "[1]"
-		*     PREDICATE <-- process "[parent::book]" first
-		*       SORT
-		*         COLLECT  'parent' 'name' 'node' book
-		*           NODE
-		*     ELEM Object is a number : 1
-		*/
-                if (op->ch1 != -1)
-                    total +=
-                        xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-		CHECK_ERROR0;
-                if (op->ch2 == -1)
-                    break;
-                if (ctxt->value == NULL)
+                break;
+            case XPATH_OP_AND:
+            case XPATH_OP_OR:
+            case XPATH_OP_EQUAL:
+            case XPATH_OP_CMP:
+            case XPATH_OP_PLUS:
+            case XPATH_OP_MULT:
+                if (f & XP_EXPR_CONSTANT) {
+                    xmlXPathFoldOp(pctxt, op);
+                    if (op->op != XPATH_OP_VALUE)
+                        f &= ~XP_EXPR_CONSTANT;
                     break;
-
-                /*
-                 * In case of errors, xmlXPathNodeSetFilter can pop additional
-                 * nodes from the stack. We have to temporarily remove the
-                 * nodeset object from the stack to avoid freeing it
-                 * prematurely.
-                 */
-                CHECK_TYPE0(XPATH_NODESET);
-                obj = xmlXPathValuePop(ctxt);
-                set = obj->nodesetval;
-                if (set != NULL)
-                    xmlXPathNodeSetFilter(ctxt, set, op->ch2,
-                                          1, set->nodeNr, 1);
-                xmlXPathValuePush(ctxt, obj);
+                }
+                if (xmlXPathIsExistsTest(comp, op))
+                    op->fast = XPATH_FAST_EXISTS;
                 break;
-            }
-        case XPATH_OP_SORT:
-            if (op->ch1 != -1)
-                total += xmlXPathCompOpEval(ctxt, &comp->steps[op->ch1]);
-	    CHECK_ERROR0;
-            if ((ctxt->value != NULL) &&
-                (ctxt->value->type == XPATH_NODESET) &&
-                (ctxt->value->nodesetval != NULL) &&
-		(ctxt->value->nodesetval->nodeNr > 1))
-	    {
-                xmlXPathNodeSetSort(ctxt->value->nodesetval);
-	    }
-            break;
-        default:
-            XP_ERROR0(XPATH_INVALID_OPERAND);
-            break;
+            case XPATH_OP_UNION:
+                f &= ~XP_EXPR_CONSTANT;
+                break;
+            default:
+                f = 0;
+                break;
+        }
+
+        if (((op->op == XPATH_OP_PREDICATE) || (op->op == XPATH_OP_FILTER)) &&
+            (op->ch2 >= 0) &&
+            (xmlXPathIsLastTest(comp, &comp->steps[op->ch2])))
+            comp->steps[op->ch2].fast = XPATH_FAST_LAST;
+
+        flags[i] = f;
     }
 
-    ctxt->context->depth -= 1;
-    return (total);
+    xmlXPathOptimizeExpression(pctxt, &comp->steps[comp->last]);
+    xmlXPathMarkInvariants(pctxt, flags, comp->last, 0);
+
+    xmlFree(flags);
 }
 
-/**
- * Evaluates if the expression evaluates to true.
- *
- * @param ctxt  the XPath parser context
- * @param op  the step operation
- * @param isPredicate  whether a predicate is evaluated
- * @returns 1 if true, 0 if false and -1 on API or internal errors.
+/*
+ * Compile without tracing, see xmlXPathCtxtCompile.
  */
-static int
-xmlXPathCompOpEvalToBoolean(xmlXPathParserContextPtr ctxt,
-			    xmlXPathStepOpPtr op,
-			    int isPredicate)
-{
-    xmlXPathObjectPtr resObj = NULL;
+static xmlXPathCompExprPtr
+xmlXPathCtxtCompileInternal(xmlXPathContextPtr ctxt, const xmlChar *str) {
+    xmlXPathParserContextPtr pctxt;
+    xmlXPathContextPtr tmpctxt = NULL;
+    xmlXPathCompExprPtr comp;
+    int oldDepth = 0;
 
-start:
-    if (OP_LIMIT_EXCEEDED(ctxt, 1))
-        return(0);
-    /* comp = ctxt->comp; */
-    switch (op->op) {
-        case XPATH_OP_END:
-            return (0);
-	case XPATH_OP_VALUE:
-	    resObj = (xmlXPathObjectPtr) op->value4;
-	    if (isPredicate)
-		return(xmlXPathEvaluatePredicateResult(ctxt, resObj));
-	    return(xmlXPathCastToBoolean(resObj));
-	case XPATH_OP_SORT:
-	    /*
-	    * We don't need sorting for boolean results. Skip this one.
-	    */
-            if (op->ch1 != -1) {
-		op = &ctxt->comp->steps[op->ch1];
-		goto start;
-	    }
-	    return(0);
-	case XPATH_OP_COLLECT:
-	    if (op->ch1 == -1)
-		return(0);
+    if (str == NULL)
+        return(NULL);
 
-            xmlXPathCompOpEval(ctxt, &ctxt->comp->steps[op->ch1]);
-	    if (ctxt->error != XPATH_EXPRESSION_OK)
-		return(-1);
+#ifdef XPATH_STREAMING
+    comp = xmlXPathTryStreamCompile(ctxt, str);
+    if (comp != NULL)
+        return(comp);
+#endif
 
-            xmlXPathNodeCollectAndTest(ctxt, op, NULL, NULL, 1);
-	    if (ctxt->error != XPATH_EXPRESSION_OK)
-		return(-1);
+    xmlInitParser();
 
-	    resObj = xmlXPathValuePop(ctxt);
-	    if (resObj == NULL)
-		return(-1);
-	    break;
-	default:
-	    /*
-	    * Fallback to call xmlXPathCompOpEval().
-	    */
-	    xmlXPathCompOpEval(ctxt, op);
-	    if (ctxt->error != XPATH_EXPRESSION_OK)
-		return(-1);
+    /*
+     * We need an xmlXPathContext for the depth check.
+     */
+    if (ctxt == NULL) {
+        tmpctxt = xmlXPathNewContext(NULL);
+        if (tmpctxt == NULL)
+            return(NULL);
+        ctxt = tmpctxt;
+    }
 
-	    resObj = xmlXPathValuePop(ctxt);
-	    if (resObj == NULL)
-		return(-1);
-	    break;
+    pctxt = xmlXPathNewParserContext(str, ctxt);
+    if (pctxt == NULL) {
+        if (tmpctxt != NULL)
+            xmlXPathFreeContext(tmpctxt);
+        return NULL;
     }
 
-    if (resObj) {
-	int res;
+    oldDepth = ctxt->depth;
+    xmlXPathCompileExpr(pctxt, 1);
+    ctxt->depth = oldDepth;
 
-	if (resObj->type == XPATH_BOOLEAN) {
-	    res = resObj->boolval;
-	} else if (isPredicate) {
-	    /*
-	    * For predicates a result of type "number" is handled
-	    * differently:
-	    * SPEC XPath 1.0:
-	    * "If the result is a number, the result will be converted
-	    *  to true if the number is equal to the context position
-	    *  and will be converted to false otherwise;"
-	    */
-	    res = xmlXPathEvaluatePredicateResult(ctxt, resObj);
-	} else {
-	    res = xmlXPathCastToBoolean(resObj);
+    if( pctxt->error != XPATH_EXPRESSION_OK )
+    {
+        xmlXPathFreeParserContext(pctxt);
+        if (tmpctxt != NULL)
+            xmlXPathFreeContext(tmpctxt);
+        return(NULL);
+    }
+
+    if (*pctxt->cur != 0) {
+	/*
+	 * aleksey: in some cases this line prints *second* error message
+	 * (see bug #78858) and probably this should be fixed.
+	 * However, we are not sure that all error messages are printed
+	 * out in other places. It's not critical so we leave it as-is for now
+	 */
+	xmlXPatherror(pctxt, __FILE__, __LINE__, XPATH_EXPR_ERROR);
+	comp = NULL;
+    } else {
+	comp = pctxt->comp;
+	if ((comp->nbStep > 1) && (comp->last >= 0)) {
+            if (ctxt != NULL)
+                oldDepth = ctxt->depth;
+	    xmlXPathOptimizeCompExpr(pctxt);
+            if (ctxt != NULL)
+                ctxt->depth = oldDepth;
 	}
-	xmlXPathReleaseObject(ctxt->context, resObj);
-	return(res);
+	pctxt->comp = NULL;
     }
+    xmlXPathFreeParserContext(pctxt);
+    if (tmpctxt != NULL)
+        xmlXPathFreeContext(tmpctxt);
 
-    return(0);
+    if (comp != NULL) {
+	comp->expr = xmlStrdup(str);
+    }
+    return(comp);
 }
 
-#ifdef XPATH_STREAMING
 /**
- * Evaluate the Precompiled Streamable XPath expression in the given context.
+ * Compile an XPath expression
  *
- * @param pctxt  the XPath parser context with the compiled expression
+ * @param ctxt  an XPath context
+ * @param str  the XPath expression
+ * @returns the xmlXPathCompExpr resulting from the compilation or NULL.
+ *         the caller has to free the object.
+ */
+xmlXPathCompExpr *
+xmlXPathCtxtCompile(xmlXPathContext *ctxt, const xmlChar *str) {
+    xmlXPathCompExprPtr comp;
+    double start;
+
+    XML_TRACE_BEGIN(xpath_compile, 0, (const char *) str, start);
+    comp = xmlXPathCtxtCompileInternal(ctxt, str);
+    XML_TRACE_END(xpath_compile, XML_TRACE_XPATH_COMPILE, (const char *) str,
+                  (str != NULL) ? (long) strlen((const char *) str) : -1,
+                  start);
+
+    return(comp);
+}
+
+/**
+ * Compile an XPath expression
+ *
+ * @param str  the XPath expression
+ * @returns the xmlXPathCompExpr resulting from the compilation or NULL.
+ *         the caller has to free the object.
+ */
+xmlXPathCompExpr *
+xmlXPathCompile(const xmlChar *str) {
+    return(xmlXPathCtxtCompile(NULL, str));
+}
+
+/**
+ * Evaluate the Precompiled XPath expression in the given context.
+ * The caller has to free `resObj`.
+ *
+ * @param comp  the compiled XPath expression
+ * @param ctxt  the XPath context
+ * @param resObjPtr  the resulting XPath object or NULL
+ * @param toBool  1 if only a boolean result is requested
+ * @returns the xmlXPathObject resulting from the evaluation or NULL.
+ *         the caller has to free the object.
  */
 static int
-xmlXPathRunStreamEval(xmlXPathParserContextPtr pctxt, xmlPatternPtr comp,
-		      xmlXPathObjectPtr *resultSeq, int toBool)
+xmlXPathCompiledEvalInternal(xmlXPathCompExprPtr comp,
+			     xmlXPathContextPtr ctxt,
+			     xmlXPathObjectPtr *resObjPtr,
+			     int toBool)
 {
-    int max_depth, min_depth;
-    int from_root;
-    int ret, depth;
-    int eval_all_nodes;
-    xmlNodePtr cur = NULL, limit = NULL;
-    xmlStreamCtxtPtr patstream = NULL;
-    xmlXPathContextPtr ctxt = pctxt->context;
+    xmlXPathParserContextPtr pctxt;
+    xmlXPathObjectPtr resObj = NULL;
+    xmlMemBudget *oldBudget;
+    double start;
+    int res, handled;
 
-    if ((ctxt == NULL) || (comp == NULL))
-        return(-1);
-    max_depth = xmlPatternMaxDepth(comp);
-    if (max_depth == -1)
-        return(-1);
-    if (max_depth == -2)
-        max_depth = 10000;
-    min_depth = xmlPatternMinDepth(comp);
-    if (min_depth == -1)
-        return(-1);
-    from_root = xmlPatternFromRoot(comp);
-    if (from_root < 0)
-        return(-1);
+    if (comp == NULL)
+	return(-1);
+    xmlInitParser();
 
-    if (! toBool) {
-	if (resultSeq == NULL)
-	    return(-1);
-	*resultSeq = xmlXPathCacheNewNodeSet(pctxt, NULL);
-	if (*resultSeq == NULL)
-	    return(-1);
+    xmlResetError(&ctxt->lastError);
+
+    xmlMemBudgetReset(ctxt->memBudget);
+    xmlXPathStartDeadline(ctxt);
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+
+    pctxt = xmlXPathCompParserContext(comp, ctxt);
+    if (pctxt == NULL) {
+        xmlMemBudgetLeave(oldBudget);
+        return(-1);
     }
 
+    XML_TRACE_BEGIN(xpath_eval, 0, (const char *) comp->expr, start);
+
     /*
-     * handle the special cases of "/" amd "." being matched
+     * Aggregates over location paths can be evaluated lazily, but
+     * not profiled.
      */
-    if (min_depth == 0) {
-        int res;
-
-	if (from_root) {
-	    /* Select "/" */
-	    if (toBool)
-		return(1);
-            res = xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval,
-                                           (xmlNodePtr) ctxt->doc);
-	} else {
-	    /* Select "self::node()" */
-	    if (toBool)
-		return(1);
-            res = xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval,
-                                           ctxt->node);
-	}
+    if (ctxt->flags & XML_XPATH_PROFILE)
+        handled = 0;
+    else
+        handled = xmlXPathIterAggregate(pctxt, toBool, &res);
+    if (handled == 0)
+        res = xmlXPathRunEval(pctxt, toBool);
+    else if (handled < 0)
+        res = -1;
+    else if (!toBool)
+        res = 0;
 
-        if (res < 0)
-            xmlXPathPErrMemory(pctxt);
-    }
-    if (max_depth == 0) {
-	return(0);
+    if (pctxt->error == XPATH_EXPRESSION_OK) {
+        if (pctxt->valueNr != ((toBool) ? 0 : 1))
+            xmlXPathErr(pctxt, XPATH_STACK_ERROR);
+        else if (!toBool)
+            resObj = xmlXPathValuePop(pctxt);
     }
 
-    if (from_root) {
-        cur = (xmlNodePtr)ctxt->doc;
-    } else if (ctxt->node != NULL) {
-        switch (ctxt->node->type) {
-            case XML_ELEMENT_NODE:
-            case XML_DOCUMENT_NODE:
-            case XML_DOCUMENT_FRAG_NODE:
-            case XML_HTML_DOCUMENT_NODE:
-	        cur = ctxt->node;
-		break;
-            case XML_ATTRIBUTE_NODE:
-            case XML_TEXT_NODE:
-            case XML_CDATA_SECTION_NODE:
-            case XML_ENTITY_REF_NODE:
-            case XML_ENTITY_NODE:
-            case XML_PI_NODE:
-            case XML_COMMENT_NODE:
-            case XML_NOTATION_NODE:
-            case XML_DTD_NODE:
-            case XML_DOCUMENT_TYPE_NODE:
-            case XML_ELEMENT_DECL:
-            case XML_ATTRIBUTE_DECL:
-            case XML_ENTITY_DECL:
-            case XML_NAMESPACE_DECL:
-            case XML_XINCLUDE_START:
-            case XML_XINCLUDE_END:
-		break;
-	}
-	limit = cur;
-    }
-    if (cur == NULL) {
-        return(0);
-    }
+    if (resObjPtr)
+        *resObjPtr = resObj;
+    else
+        xmlXPathReleaseObject(ctxt, resObj);
 
-    patstream = xmlPatternGetStreamCtxt(comp);
-    if (patstream == NULL) {
-        xmlXPathPErrMemory(pctxt);
-	return(-1);
-    }
+    pctxt->comp = NULL;
+    xmlXPathFreeParserContext(pctxt);
+    xmlMemBudgetLeave(oldBudget);
 
-    eval_all_nodes = xmlStreamWantsAnyNode(patstream);
+    XML_TRACE_END(xpath_eval, XML_TRACE_XPATH_EVAL, (const char *) comp->expr,
+                  -1L, start);
 
-    if (from_root) {
-	ret = xmlStreamPush(patstream, NULL, NULL);
-	if (ret < 0) {
-	} else if (ret == 1) {
-	    if (toBool)
-		goto return_1;
-	    if (xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval, cur) < 0)
-                xmlXPathPErrMemory(pctxt);
-	}
-    }
-    depth = 0;
-    goto scan_children;
-next_node:
-    do {
-        if (ctxt->opLimit != 0) {
-            if (ctxt->opCount >= ctxt->opLimit) {
-                xmlXPathErr(ctxt, XPATH_RECURSION_LIMIT_EXCEEDED);
-                xmlFreeStreamCtxt(patstream);
-                return(-1);
-            }
-            ctxt->opCount++;
-        }
+    return(res);
+}
 
-	switch (cur->type) {
-	    case XML_ELEMENT_NODE:
-	    case XML_TEXT_NODE:
-	    case XML_CDATA_SECTION_NODE:
-	    case XML_COMMENT_NODE:
-	    case XML_PI_NODE:
-		if (cur->type == XML_ELEMENT_NODE) {
-		    ret = xmlStreamPush(patstream, cur->name,
-				(cur->ns ? cur->ns->href : NULL));
-		} else if (eval_all_nodes)
-		    ret = xmlStreamPushNode(patstream, NULL, NULL, cur->type);
-		else
-		    break;
+/**
+ * Evaluate the Precompiled XPath expression in the given context.
+ *
+ * The compiled expression is only read, so it can be evaluated
+ * concurrently by several threads, each with its own XPath context.
+ *
+ * @param comp  the compiled XPath expression
+ * @param ctx  the XPath context
+ * @returns the xmlXPathObject resulting from the evaluation or NULL.
+ *         the caller has to free the object.
+ */
+xmlXPathObject *
+xmlXPathCompiledEval(xmlXPathCompExpr *comp, xmlXPathContext *ctx)
+{
+    xmlXPathObjectPtr res = NULL;
 
-		if (ret < 0) {
-		    xmlXPathPErrMemory(pctxt);
-		} else if (ret == 1) {
-		    if (toBool)
-			goto return_1;
-		    if (xmlXPathNodeSetAddUnique((*resultSeq)->nodesetval,
-                                                 cur) < 0)
-                        xmlXPathPErrMemory(pctxt);
-		}
-		if ((cur->children == NULL) || (depth >= max_depth)) {
-		    ret = xmlStreamPop(patstream);
-		    while (cur->next != NULL) {
-			cur = cur->next;
-			if ((cur->type != XML_ENTITY_DECL) &&
-			    (cur->type != XML_DTD_NODE))
-			    goto next_node;
-		    }
-		}
-	    default:
-		break;
-	}
+    xmlXPathCompiledEvalInternal(comp, ctx, &res, 0);
+    return(res);
+}
+
+/**
+ * Applies the XPath boolean() function on the result of the given
+ * compiled expression.
+ *
+ * @param comp  the compiled XPath expression
+ * @param ctxt  the XPath context
+ * @returns 1 if the expression evaluated to true, 0 if to false and
+ *         -1 in API and internal errors.
+ */
+int
+xmlXPathCompiledEvalToBoolean(xmlXPathCompExpr *comp,
+			      xmlXPathContext *ctxt)
+{
+    return(xmlXPathCompiledEvalInternal(comp, ctxt, NULL, 1));
+}
 
-scan_children:
-	if (cur->type == XML_NAMESPACE_DECL) break;
-	if ((cur->children != NULL) && (depth < max_depth)) {
-	    /*
-	     * Do not descend on entities declarations
-	     */
-	    if (cur->children->type != XML_ENTITY_DECL) {
-		cur = cur->children;
-		depth++;
-		/*
-		 * Skip DTDs
-		 */
-		if (cur->type != XML_DTD_NODE)
-		    continue;
-	    }
-	}
+/*
+ * Maximum number of location steps evaluated lazily by an iterator.
+ */
+#define XPATH_ITER_MAX_STEPS 30
 
-	if (cur == limit)
-	    break;
+struct _xmlXPathIterator {
+    xmlXPathContextPtr ctxt;
+    xmlXPathParserContextPtr pctxt;
+    int ownsPctxt;
+    int error;
+    int done;
+
+    /* Materialized result */
+    xmlXPathObjectPtr result;
+    int index;
+
+    /* Location path evaluated lazily */
+    int nbSteps;
+    xmlXPathStepOpPtr steps[XPATH_ITER_MAX_STEPS];
+    const xmlChar *URIs[XPATH_ITER_MAX_STEPS];
+    unsigned childMask;
+    unsigned descMask;
+    xmlNodePtr root;
+    xmlNodePtr cur;
+    xmlAttrPtr attr;
+    int depth;
+    int maxDepth;
+    unsigned *selfTab;
+    unsigned *descTab;
+};
 
-	while (cur->next != NULL) {
-	    cur = cur->next;
-	    if ((cur->type != XML_ENTITY_DECL) &&
-		(cur->type != XML_DTD_NODE))
-		goto next_node;
-	}
+/*
+ * Check whether an expression calls position() or last().
+ */
+static int
+xmlXPathIterUsesPosition(xmlXPathCompExprPtr comp, xmlXPathStepOpPtr op,
+                         int depth) {
+    if (depth >= XPATH_MAX_RECURSION_DEPTH)
+        return(1);
 
-	do {
-	    cur = cur->parent;
-	    depth--;
-	    if ((cur == NULL) || (cur == limit) ||
-                (cur->type == XML_DOCUMENT_NODE))
-	        goto done;
-	    if (cur->type == XML_ELEMENT_NODE) {
-		ret = xmlStreamPop(patstream);
-	    } else if ((eval_all_nodes) &&
-		((cur->type == XML_TEXT_NODE) ||
-		 (cur->type == XML_CDATA_SECTION_NODE) ||
-		 (cur->type == XML_COMMENT_NODE) ||
-		 (cur->type == XML_PI_NODE)))
-	    {
-		ret = xmlStreamPop(patstream);
-	    }
-	    if (cur->next != NULL) {
-		cur = cur->next;
-		break;
-	    }
-	} while (cur != NULL);
+    if ((op->op == XPATH_OP_FUNCTION) && (op->value5 == NULL) &&
+        ((xmlStrEqual(op->value4, BAD_CAST "position")) ||
+         (xmlStrEqual(op->value4, BAD_CAST "last"))))
+        return(1);
 
-    } while ((cur != NULL) && (depth >= 0));
+    /* OP_VALUE has invalid ch1. */
+    if (op->op == XPATH_OP_VALUE)
+        return(0);
 
-done:
+    if ((op->ch1 != -1) &&
+        (xmlXPathIterUsesPosition(comp, &comp->steps[op->ch1], depth + 1)))
+        return(1);
+    if ((op->ch2 != -1) &&
+        (xmlXPathIterUsesPosition(comp, &comp->steps[op->ch2], depth + 1)))
+        return(1);
 
-    if (patstream)
-	xmlFreeStreamCtxt(patstream);
     return(0);
-
-return_1:
-    if (patstream)
-	xmlFreeStreamCtxt(patstream);
-    return(1);
 }
-#endif /* XPATH_STREAMING */
 
-/**
- * Evaluate the Precompiled XPath expression in the given context.
- *
- * @param ctxt  the XPath parser context with the compiled expression
- * @param toBool  evaluate to a boolean result
+/*
+ * Check whether a chain of predicates can be evaluated for a single
+ * node, independently of its position in the axis. This is the case
+ * if each predicate has a boolean or node-set value and doesn't call
+ * position() or last().
  */
 static int
-xmlXPathRunEval(xmlXPathParserContextPtr ctxt, int toBool)
-{
-    xmlXPathCompExprPtr comp;
-    int oldDepth;
+xmlXPathIterCanEvalPredicates(xmlXPathCompExprPtr comp,
+                              xmlXPathStepOpPtr op) {
+    while (op != NULL) {
+        xmlXPathStepOpPtr expr;
+
+        if ((op->op != XPATH_OP_PREDICATE) || (op->ch2 == -1))
+            return(0);
+        expr = &comp->steps[op->ch2];
+
+        switch (expr->op) {
+            case XPATH_OP_AND:
+            case XPATH_OP_OR:
+            case XPATH_OP_EQUAL:
+            case XPATH_OP_CMP:
+            case XPATH_OP_UNION:
+            case XPATH_OP_ROOT:
+            case XPATH_OP_NODE:
+            case XPATH_OP_COLLECT:
+            case XPATH_OP_SORT:
+                break;
+            case XPATH_OP_FUNCTION:
+                if ((expr->value5 == NULL) &&
+                    ((xmlStrEqual(expr->value4, BAD_CAST "not")) ||
+                     (xmlStrEqual(expr->value4, BAD_CAST "boolean")) ||
+                     (xmlStrEqual(expr->value4, BAD_CAST "true")) ||
+                     (xmlStrEqual(expr->value4, BAD_CAST "false")) ||
+                     (xmlStrEqual(expr->value4, BAD_CAST "contains")) ||
+                     (xmlStrEqual(expr->value4, BAD_CAST "starts-with")) ||
+                     (xmlStrEqual(expr->value4, BAD_CAST "lang"))))
+                    break;
+                return(0);
+            default:
+                return(0);
+        }
 
-    if ((ctxt == NULL) || (ctxt->comp == NULL))
-	return(-1);
+        if (xmlXPathIterUsesPosition(comp, expr, 0))
+            return(0);
 
-    if (ctxt->valueTab == NULL) {
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-        int valueMax = 1;
-#else
-        int valueMax = 10;
-#endif
+        op = (op->ch1 != -1) ? &comp->steps[op->ch1] : NULL;
+    }
 
-	/* Allocate the value stack */
-	ctxt->valueTab = xmlMalloc(valueMax * sizeof(xmlXPathObjectPtr));
-	if (ctxt->valueTab == NULL) {
-	    xmlXPathPErrMemory(ctxt);
-	    return(-1);
-	}
-	ctxt->valueNr = 0;
-	ctxt->valueMax = valueMax;
-	ctxt->value = NULL;
+    return(1);
+}
+
+/*
+ * Set up lazy evaluation of a location path made of child, descendant,
+ * descendant-or-self and self steps, optionally followed by an
+ * attribute step. Returns 1 if the expression can be evaluated lazily,
+ * 0 if it must be materialized, -1 if an error was raised.
+ */
+static int
+xmlXPathIterSetup(xmlXPathIteratorPtr iter, xmlXPathCompExprPtr comp,
+                  xmlXPathStepOpPtr op) {
+    xmlXPathContextPtr ctxt = iter->ctxt;
+    xmlXPathStepOpPtr chain[XPATH_ITER_MAX_STEPS];
+    xmlNodePtr root;
+    int nbSteps = 0, i;
+
+    if (op->op == XPATH_OP_SORT)
+        op = &comp->steps[op->ch1];
+
+    while (op->op == XPATH_OP_COLLECT) {
+        switch (op->value) {
+            case AXIS_ATTRIBUTE:
+                if (nbSteps != 0)
+                    return(0);
+                break;
+            case AXIS_CHILD:
+            case AXIS_DESCENDANT:
+            case AXIS_DESCENDANT_OR_SELF:
+            case AXIS_SELF:
+                break;
+            default:
+                return(0);
+        }
+        if ((op->ch2 != -1) &&
+            (!xmlXPathIterCanEvalPredicates(comp, &comp->steps[op->ch2])))
+            return(0);
+        if ((nbSteps >= XPATH_ITER_MAX_STEPS) || (op->ch1 == -1))
+            return(0);
+        chain[nbSteps++] = op;
+        op = &comp->steps[op->ch1];
+    }
+
+    if (op->op == XPATH_OP_ROOT) {
+        root = (xmlNodePtr) ctxt->doc;
+    } else if (op->op == XPATH_OP_NODE) {
+        root = ctxt->node;
+    } else {
+        return(0);
     }
-#ifdef XPATH_STREAMING
-    if (ctxt->comp->stream) {
-	int res;
+    if ((root == NULL) ||
+        ((root->type != XML_ELEMENT_NODE) &&
+         (root->type != XML_DOCUMENT_NODE) &&
+         (root->type != XML_HTML_DOCUMENT_NODE) &&
+         (root->type != XML_DOCUMENT_FRAG_NODE)))
+        return(0);
 
-	if (toBool) {
-	    /*
-	    * Evaluation to boolean result.
-	    */
-	    res = xmlXPathRunStreamEval(ctxt, ctxt->comp->stream, NULL, 1);
-	    if (res != -1)
-		return(res);
-	} else {
-	    xmlXPathObjectPtr resObj = NULL;
+    for (i = 0; i < nbSteps; i++) {
+        xmlXPathStepOpPtr step = chain[nbSteps - 1 - i];
+        const xmlChar *URI = NULL;
 
-	    /*
-	    * Evaluation to a sequence.
-	    */
-	    res = xmlXPathRunStreamEval(ctxt, ctxt->comp->stream, &resObj, 0);
+        if (step->value4 != NULL) {
+            URI = xmlXPathNsLookup(ctxt, step->value4);
+            if (URI == NULL) {
+                xmlXPathErrFmt(iter->pctxt, XPATH_UNDEF_PREFIX_ERROR,
+                               "Undefined namespace prefix: %s\n",
+                               (const char *) step->value4);
+                return(-1);
+            }
+        }
 
-	    if ((res != -1) && (resObj != NULL)) {
-		xmlXPathValuePush(ctxt, resObj);
-		return(0);
-	    }
-	    if (resObj != NULL)
-		xmlXPathReleaseObject(ctxt->context, resObj);
-	}
-	/*
-	* QUESTION TODO: This falls back to normal XPath evaluation
-	* if res == -1. Is this intended?
-	*/
-    }
-#endif
-    comp = ctxt->comp;
-    if (comp->last < 0) {
-        xmlXPathErr(ctxt, XPATH_STACK_ERROR);
-	return(-1);
+        iter->steps[i] = step;
+        iter->URIs[i] = URI;
+        if (step->value == AXIS_CHILD)
+            iter->childMask |= 1u << i;
+        else if ((step->value == AXIS_DESCENDANT) ||
+                 (step->value == AXIS_DESCENDANT_OR_SELF))
+            iter->descMask |= 1u << i;
     }
-    oldDepth = ctxt->context->depth;
-    if (toBool)
-	return(xmlXPathCompOpEvalToBoolean(ctxt,
-	    &comp->steps[comp->last], 0));
-    else
-	xmlXPathCompOpEval(ctxt, &comp->steps[comp->last]);
-    ctxt->context->depth = oldDepth;
+    iter->nbSteps = nbSteps;
+    iter->root = root;
+    iter->depth = -1;
 
-    return(0);
+    return(1);
 }
 
-/************************************************************************
- *									*
- *			Public interfaces				*
- *									*
- ************************************************************************/
-
-/**
- * Evaluate a predicate result for the current node.
- * A PredicateExpr is evaluated by evaluating the Expr and converting
- * the result to a boolean. If the result is a number, the result will
- * be converted to true if the number is equal to the position of the
- * context node in the context node list (as returned by the position
- * function) and will be converted to false otherwise; if the result
- * is not a number, then the result will be converted as if by a call
- * to the boolean function.
- *
- * @param ctxt  the XPath context
- * @param res  the Predicate Expression evaluation result
- * @returns 1 if predicate is true, 0 otherwise
+/*
+ * Check whether a node matches the node test of a step.
  */
-int
-xmlXPathEvalPredicate(xmlXPathContext *ctxt, xmlXPathObject *res) {
-    if ((ctxt == NULL) || (res == NULL)) return(0);
-    switch (res->type) {
-        case XPATH_BOOLEAN:
-	    return(res->boolval);
-        case XPATH_NUMBER:
-	    return(res->floatval == ctxt->proximityPosition);
-        case XPATH_NODESET:
-        case XPATH_XSLT_TREE:
-	    if (res->nodesetval == NULL)
-		return(0);
-	    return(res->nodesetval->nodeNr != 0);
-        case XPATH_STRING:
-	    return((res->stringval != NULL) &&
-	           (xmlStrlen(res->stringval) != 0));
+static int
+xmlXPathIterNodeTest(xmlXPathStepOpPtr op, const xmlChar *URI,
+                     xmlNodePtr node) {
+    xmlXPathTestVal test = (xmlXPathTestVal) op->value2;
+    xmlXPathTypeVal type = (xmlXPathTypeVal) op->value3;
+    const xmlChar *name = op->value5;
+    xmlElementType principal;
+
+    principal = (op->value == AXIS_ATTRIBUTE) ?
+                XML_ATTRIBUTE_NODE : XML_ELEMENT_NODE;
+
+    switch (test) {
+        case NODE_TEST_TYPE:
+            if (type == NODE_TYPE_NODE) {
+                switch (node->type) {
+                    case XML_DOCUMENT_NODE:
+                    case XML_HTML_DOCUMENT_NODE:
+                    case XML_ELEMENT_NODE:
+                    case XML_ATTRIBUTE_NODE:
+                    case XML_PI_NODE:
+                    case XML_COMMENT_NODE:
+                    case XML_CDATA_SECTION_NODE:
+                    case XML_TEXT_NODE:
+                        return(1);
+                    default:
+                        return(0);
+                }
+            }
+            if (node->type == (xmlElementType) type)
+                return(1);
+            return((type == NODE_TYPE_TEXT) &&
+                   (node->type == XML_CDATA_SECTION_NODE));
+        case NODE_TEST_PI:
+            return((node->type == XML_PI_NODE) &&
+                   ((name == NULL) || (xmlStrEqual(name, node->name))));
+        case NODE_TEST_ALL:
+            if (node->type != principal)
+                return(0);
+            return((URI == NULL) ||
+                   ((node->ns != NULL) && (xmlStrEqual(URI, node->ns->href))));
+        case NODE_TEST_NAME:
+            if ((node->type != principal) || (!xmlStrEqual(name, node->name)))
+                return(0);
+            if (URI != NULL)
+                return((node->ns != NULL) &&
+                       (xmlStrEqual(URI, node->ns->href)));
+            if (node->type == XML_ATTRIBUTE_NODE)
+                return((node->ns == NULL) || (node->ns->prefix == NULL));
+            return(node->ns == NULL);
         default:
-	    break;
+            return(0);
     }
-    return(0);
 }
 
-/**
- * Evaluate a predicate result for the current node.
- * A PredicateExpr is evaluated by evaluating the Expr and converting
- * the result to a boolean. If the result is a number, the result will
- * be converted to true if the number is equal to the position of the
- * context node in the context node list (as returned by the position
- * function) and will be converted to false otherwise; if the result
- * is not a number, then the result will be converted as if by a call
- * to the boolean function.
- *
- * @param ctxt  the XPath Parser context
- * @param res  the Predicate Expression evaluation result
- * @returns 1 if predicate is true, 0 otherwise
+/*
+ * Evaluate the predicates of a step with a node as context node.
  */
-int
-xmlXPathEvaluatePredicateResult(xmlXPathParserContext *ctxt,
-                                xmlXPathObject *res) {
-    if ((ctxt == NULL) || (res == NULL)) return(0);
-    switch (res->type) {
-        case XPATH_BOOLEAN:
-	    return(res->boolval);
-        case XPATH_NUMBER:
-#if defined(__BORLANDC__) || (defined(_MSC_VER) && (_MSC_VER == 1200))
-	    return((res->floatval == ctxt->context->proximityPosition) &&
-	           (!xmlXPathIsNaN(res->floatval))); /* MSC pbm Mark Vakoc !*/
-#else
-	    return(res->floatval == ctxt->context->proximityPosition);
-#endif
-        case XPATH_NODESET:
-        case XPATH_XSLT_TREE:
-	    if (res->nodesetval == NULL)
-		return(0);
-	    return(res->nodesetval->nodeNr != 0);
-        case XPATH_STRING:
-	    return((res->stringval != NULL) && (res->stringval[0] != 0));
-        default:
-	    break;
+static int
+xmlXPathIterPredicates(xmlXPathParserContextPtr pctxt, xmlXPathStepOpPtr op,
+                       xmlNodePtr node) {
+    xmlXPathCompExprPtr comp = pctxt->comp;
+    int res;
+
+    if (op->ch1 != -1) {
+        res = xmlXPathIterPredicates(pctxt, &comp->steps[op->ch1], node);
+        if (res <= 0)
+            return(res);
     }
-    return(0);
+
+    pctxt->context->node = node;
+    pctxt->context->contextSize = 1;
+    pctxt->context->proximityPosition = 1;
+    if ((node->doc != NULL) && (node->type != XML_NAMESPACE_DECL))
+        pctxt->context->doc = node->doc;
+
+    res = xmlXPathCompOpEvalToBoolean(pctxt, &comp->steps[op->ch2], 1);
+    if (pctxt->error != XPATH_EXPRESSION_OK)
+        return(-1);
+    return(res);
 }
 
-#ifdef XPATH_STREAMING
-/**
- * Try to compile the XPath expression as a streamable subset.
- *
- * @param ctxt  an XPath context
- * @param str  the XPath expression
- * @returns the compiled expression or NULL if failed to compile.
+/*
+ * Check whether a node matches a step. Returns 1 if it matches, 0 if
+ * not and -1 if an error occurred.
  */
-static xmlXPathCompExprPtr
-xmlXPathTryStreamCompile(xmlXPathContextPtr ctxt, const xmlChar *str) {
-    /*
-     * Optimization: use streaming patterns when the XPath expression can
-     * be compiled to a stream lookup
-     */
-    xmlPatternPtr stream;
-    xmlXPathCompExprPtr comp;
-    xmlDictPtr dict = NULL;
-    const xmlChar **namespaces = NULL;
-    xmlNsPtr ns;
-    int i, j;
+static int
+xmlXPathIterMatchStep(xmlXPathIteratorPtr iter, int i, xmlNodePtr node) {
+    xmlXPathStepOpPtr op = iter->steps[i];
+    xmlXPathContextPtr ctxt = iter->ctxt;
+    xmlNodePtr oldnode;
+    xmlDocPtr olddoc;
+    int oldcs, oldpp, res;
 
-    if ((!xmlStrchr(str, '[')) && (!xmlStrchr(str, '(')) &&
-        (!xmlStrchr(str, '@'))) {
-	const xmlChar *tmp;
-        int res;
+    if (!xmlXPathIterNodeTest(op, iter->URIs[i], node))
+        return(0);
+    if (op->ch2 == -1)
+        return(1);
 
-	/*
-	 * We don't try to handle expressions using the verbose axis
-	 * specifiers ("::"), just the simplified form at this point.
-	 * Additionally, if there is no list of namespaces available and
-	 *  there's a ":" in the expression, indicating a prefixed QName,
-	 *  then we won't try to compile either. xmlPatterncompile() needs
-	 *  to have a list of namespaces at compilation time in order to
-	 *  compile prefixed name tests.
-	 */
-	tmp = xmlStrchr(str, ':');
-	if ((tmp != NULL) &&
-	    ((ctxt == NULL) || (ctxt->nsNr == 0) || (tmp[1] == ':')))
-	    return(NULL);
+    oldnode = ctxt->node;
+    olddoc = ctxt->doc;
+    oldcs = ctxt->contextSize;
+    oldpp = ctxt->proximityPosition;
 
-	if (ctxt != NULL) {
-	    dict = ctxt->dict;
-	    if (ctxt->nsNr > 0) {
-		namespaces = xmlMalloc(2 * (ctxt->nsNr + 1) * sizeof(xmlChar*));
-		if (namespaces == NULL) {
-		    xmlXPathErrMemory(ctxt);
-		    return(NULL);
-		}
-		for (i = 0, j = 0; (j < ctxt->nsNr); j++) {
-		    ns = ctxt->namespaces[j];
-		    namespaces[i++] = ns->href;
-		    namespaces[i++] = ns->prefix;
-		}
-		namespaces[i++] = NULL;
-		namespaces[i] = NULL;
-	    }
-	}
+    res = xmlXPathIterPredicates(iter->pctxt, &iter->pctxt->comp->steps[op->ch2],
+                                 node);
 
-	res = xmlPatternCompileSafe(str, dict, XML_PATTERN_XPATH, namespaces,
-                                    &stream);
-	if (namespaces != NULL) {
-	    xmlFree((xmlChar **)namespaces);
-	}
-        if (res < 0) {
-            xmlXPathErrMemory(ctxt);
-            return(NULL);
+    ctxt->node = oldnode;
+    ctxt->doc = olddoc;
+    ctxt->contextSize = oldcs;
+    ctxt->proximityPosition = oldpp;
+
+    return(res);
+}
+
+/*
+ * Compute the set of steps matched by a node. Bit i of the result is
+ * set if the node is selected by the first i steps of the path. The
+ * parent's sets are passed in `parentSelf` and `parentDesc`, the
+ * latter being the union of the sets of all ancestors.
+ */
+static int
+xmlXPathIterMatch(xmlXPathIteratorPtr iter, xmlNodePtr node, unsigned init,
+                  unsigned parentSelf, unsigned parentDesc, unsigned *out) {
+    unsigned self = init;
+    int i, res;
+
+    /* Nothing can match below a pruned subtree. */
+    if ((init == 0) &&
+        ((parentSelf & iter->childMask) == 0) &&
+        ((parentDesc & iter->descMask) == 0)) {
+        *out = 0;
+        return(0);
+    }
+
+    for (i = 0; i < iter->nbSteps; i++) {
+        unsigned prev = 1u << i;
+        int ok;
+
+        switch (iter->steps[i]->value) {
+            case AXIS_CHILD:
+                ok = (parentSelf & prev) != 0;
+                break;
+            case AXIS_DESCENDANT:
+                ok = (parentDesc & prev) != 0;
+                break;
+            case AXIS_DESCENDANT_OR_SELF:
+                ok = ((parentDesc | self) & prev) != 0;
+                break;
+            case AXIS_SELF:
+                ok = (self & prev) != 0;
+                break;
+            default:
+                ok = 0;
+                break;
+        }
+
+        if (ok) {
+            res = xmlXPathIterMatchStep(iter, i, node);
+            if (res < 0)
+                return(-1);
+            if (res)
+                self |= 2u << i;
         }
-	if ((stream != NULL) && (xmlPatternStreamable(stream) == 1)) {
-	    comp = xmlXPathNewCompExpr();
-	    if (comp == NULL) {
-		xmlXPathErrMemory(ctxt);
-	        xmlFreePattern(stream);
-		return(NULL);
-	    }
-	    comp->stream = stream;
-	    comp->dict = dict;
-	    if (comp->dict)
-		xmlDictReference(comp->dict);
-	    return(comp);
-	}
-	xmlFreePattern(stream);
     }
-    return(NULL);
+
+    *out = self;
+    return(0);
 }
-#endif /* XPATH_STREAMING */
 
-static void
-xmlXPathOptimizeExpression(xmlXPathParserContextPtr pctxt,
-                           xmlXPathStepOpPtr op)
-{
-    xmlXPathCompExprPtr comp = pctxt->comp;
-    xmlXPathContextPtr ctxt;
+/*
+ * Push the match sets of the current node.
+ */
+static int
+xmlXPathIterPush(xmlXPathIteratorPtr iter, unsigned self, unsigned desc) {
+    if (iter->depth >= iter->maxDepth) {
+        unsigned *tmp;
+        int newSize;
 
-    /*
-    * Try to rewrite "descendant-or-self::node()/foo" to an optimized
-    * internal representation.
-    */
+        newSize = xmlGrowCapacity(iter->maxDepth, sizeof(tmp[0]),
+                                  16, XML_MAX_ITEMS);
+        if (newSize < 0) {
+            xmlXPathPErrMemory(iter->pctxt);
+            return(-1);
+        }
+        tmp = xmlRealloc(iter->selfTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlXPathPErrMemory(iter->pctxt);
+            return(-1);
+        }
+        iter->selfTab = tmp;
+        tmp = xmlRealloc(iter->descTab, newSize * sizeof(tmp[0]));
+        if (tmp == NULL) {
+            xmlXPathPErrMemory(iter->pctxt);
+            return(-1);
+        }
+        iter->descTab = tmp;
+        iter->maxDepth = newSize;
+    }
 
-    if ((op->op == XPATH_OP_COLLECT /* 11 */) &&
-        (op->ch1 != -1) &&
-        (op->ch2 == -1 /* no predicate */))
-    {
-        xmlXPathStepOpPtr prevop = &comp->steps[op->ch1];
+    iter->selfTab[iter->depth] = self;
+    iter->descTab[iter->depth] = desc;
+    return(0);
+}
 
-        if ((prevop->op == XPATH_OP_COLLECT /* 11 */) &&
-            ((xmlXPathAxisVal) prevop->value ==
-                AXIS_DESCENDANT_OR_SELF) &&
-            (prevop->ch2 == -1) &&
-            ((xmlXPathTestVal) prevop->value2 == NODE_TEST_TYPE) &&
-            ((xmlXPathTypeVal) prevop->value3 == NODE_TYPE_NODE))
-        {
-            /*
-            * This is a "descendant-or-self::node()" without predicates.
-            * Try to eliminate it.
-            */
+/*
+ * Move to the next node of the subtree in document order. Children
+ * are skipped if no step can match them.
+ */
+static xmlNodePtr
+xmlXPathIterNextNode(xmlXPathIteratorPtr iter) {
+    xmlNodePtr cur = iter->cur;
 
-            switch ((xmlXPathAxisVal) op->value) {
-                case AXIS_CHILD:
-                case AXIS_DESCENDANT:
-                    /*
-                    * Convert "descendant-or-self::node()/child::" or
-                    * "descendant-or-self::node()/descendant::" to
-                    * "descendant::"
-                    */
-                    op->ch1   = prevop->ch1;
-                    op->value = AXIS_DESCENDANT;
-                    break;
-                case AXIS_SELF:
-                case AXIS_DESCENDANT_OR_SELF:
-                    /*
-                    * Convert "descendant-or-self::node()/self::" or
-                    * "descendant-or-self::node()/descendant-or-self::" to
-                    * to "descendant-or-self::"
-                    */
-                    op->ch1   = prevop->ch1;
-                    op->value = AXIS_DESCENDANT_OR_SELF;
-                    break;
-                default:
-                    break;
+    if (cur == NULL)
+        return(iter->root);
+
+    if ((cur->type != XML_ATTRIBUTE_NODE) &&
+        (cur->type != XML_ENTITY_REF_NODE) &&
+        (cur->children != NULL) &&
+        (cur->children->type != XML_ENTITY_DECL) &&
+        (((iter->selfTab[iter->depth] & iter->childMask) != 0) ||
+         ((iter->descTab[iter->depth] & iter->descMask) != 0))) {
+        cur = cur->children;
+        iter->depth += 1;
+    } else {
+        while (1) {
+            if (cur == iter->root)
+                return(NULL);
+            if (cur->next != NULL) {
+                cur = cur->next;
+                break;
             }
-	}
+            cur = cur->parent;
+            iter->depth -= 1;
+            if (cur == NULL)
+                return(NULL);
+        }
     }
 
-    /* OP_VALUE has invalid ch1. */
-    if (op->op == XPATH_OP_VALUE)
-        return;
-
-    /* Recurse */
-    ctxt = pctxt->context;
-    if (ctxt != NULL) {
-        if (ctxt->depth >= XPATH_MAX_RECURSION_DEPTH)
-            return;
-        ctxt->depth += 1;
+    while ((cur->type == XML_DTD_NODE) || (cur->type == XML_ENTITY_DECL)) {
+        if (cur->next != NULL) {
+            cur = cur->next;
+        } else {
+            do {
+                cur = cur->parent;
+                iter->depth -= 1;
+                if ((cur == NULL) || (cur == iter->root))
+                    return(NULL);
+            } while (cur->next == NULL);
+            cur = cur->next;
+        }
     }
-    if (op->ch1 != -1)
-        xmlXPathOptimizeExpression(pctxt, &comp->steps[op->ch1]);
-    if (op->ch2 != -1)
-	xmlXPathOptimizeExpression(pctxt, &comp->steps[op->ch2]);
-    if (ctxt != NULL)
-        ctxt->depth -= 1;
+
+    return(cur);
 }
 
-/**
- * Compile an XPath expression
- *
- * @param ctxt  an XPath context
- * @param str  the XPath expression
- * @returns the xmlXPathCompExpr resulting from the compilation or NULL.
- *         the caller has to free the object.
+/*
+ * Return the next node of a lazily evaluated location path.
  */
-xmlXPathCompExpr *
-xmlXPathCtxtCompile(xmlXPathContext *ctxt, const xmlChar *str) {
-    xmlXPathParserContextPtr pctxt;
-    xmlXPathContextPtr tmpctxt = NULL;
-    xmlXPathCompExprPtr comp;
-    int oldDepth = 0;
+static int
+xmlXPathIterNextLazy(xmlXPathIteratorPtr iter, xmlNodePtr *node) {
+    xmlXPathContextPtr ctxt = iter->ctxt;
+    unsigned last = 1u << iter->nbSteps;
+    int attrStep = (iter->nbSteps > 0) &&
+                   (iter->steps[iter->nbSteps - 1]->value == AXIS_ATTRIBUTE);
+
+    while (1) {
+        xmlNodePtr cur;
+        unsigned self, parentSelf, parentDesc;
+        int res;
 
-    if (str == NULL)
-        return(NULL);
+        while (iter->attr != NULL) {
+            xmlAttrPtr attr = iter->attr;
 
-#ifdef XPATH_STREAMING
-    comp = xmlXPathTryStreamCompile(ctxt, str);
-    if (comp != NULL)
-        return(comp);
-#endif
+            iter->attr = attr->next;
+            res = xmlXPathIterMatchStep(iter, iter->nbSteps - 1,
+                                        (xmlNodePtr) attr);
+            if (res < 0)
+                return(-1);
+            if (res) {
+                *node = (xmlNodePtr) attr;
+                return(1);
+            }
+        }
 
-    xmlInitParser();
+        cur = xmlXPathIterNextNode(iter);
+        if (cur == NULL)
+            return(0);
+        iter->cur = cur;
 
-    /*
-     * We need an xmlXPathContext for the depth check.
-     */
-    if (ctxt == NULL) {
-        tmpctxt = xmlXPathNewContext(NULL);
-        if (tmpctxt == NULL)
-            return(NULL);
-        ctxt = tmpctxt;
-    }
+        if ((XP_HAS_LIMITS(ctxt)) &&
+            (xmlXPathCheckOpLimit(iter->pctxt, 1) < 0))
+            return(-1);
 
-    pctxt = xmlXPathNewParserContext(str, ctxt);
-    if (pctxt == NULL) {
-        if (tmpctxt != NULL)
-            xmlXPathFreeContext(tmpctxt);
-        return NULL;
+        if (iter->depth < 0) {
+            iter->depth = 0;
+            res = xmlXPathIterMatch(iter, cur, 1, 0, 0, &self);
+            parentDesc = 0;
+        } else {
+            parentSelf = iter->selfTab[iter->depth - 1];
+            parentDesc = iter->descTab[iter->depth - 1];
+            res = xmlXPathIterMatch(iter, cur, 0, parentSelf, parentDesc,
+                                    &self);
+        }
+        if ((res < 0) || (xmlXPathIterPush(iter, self, parentDesc | self) < 0))
+            return(-1);
+
+        if ((attrStep) && (cur->type == XML_ELEMENT_NODE) &&
+            (self & (last >> 1)))
+            iter->attr = cur->properties;
+
+        if (self & last) {
+            *node = cur;
+            return(1);
+        }
     }
+}
 
-    oldDepth = ctxt->depth;
-    xmlXPathCompileExpr(pctxt, 1);
-    ctxt->depth = oldDepth;
+/*
+ * Allocate an iterator and check whether the expression can be
+ * evaluated lazily.
+ */
+static xmlXPathIteratorPtr
+xmlXPathIterNew(xmlXPathCompExprPtr comp, xmlXPathStepOpPtr op,
+                xmlXPathContextPtr ctxt, xmlXPathParserContextPtr pctxt,
+                int *lazy) {
+    xmlXPathIteratorPtr iter;
+    int res;
 
-    if( pctxt->error != XPATH_EXPRESSION_OK )
-    {
-        xmlXPathFreeParserContext(pctxt);
-        if (tmpctxt != NULL)
-            xmlXPathFreeContext(tmpctxt);
+    iter = xmlMalloc(sizeof(*iter));
+    if (iter == NULL) {
+        xmlXPathErrMemory(ctxt);
         return(NULL);
     }
+    memset(iter, 0, sizeof(*iter));
+    iter->ctxt = ctxt;
 
-    if (*pctxt->cur != 0) {
-	/*
-	 * aleksey: in some cases this line prints *second* error message
-	 * (see bug #78858) and probably this should be fixed.
-	 * However, we are not sure that all error messages are printed
-	 * out in other places. It's not critical so we leave it as-is for now
-	 */
-	xmlXPatherror(pctxt, __FILE__, __LINE__, XPATH_EXPR_ERROR);
-	comp = NULL;
+    if (pctxt != NULL) {
+        iter->pctxt = pctxt;
     } else {
-	comp = pctxt->comp;
-	if ((comp->nbStep > 1) && (comp->last >= 0)) {
-            if (ctxt != NULL)
-                oldDepth = ctxt->depth;
-	    xmlXPathOptimizeExpression(pctxt, &comp->steps[comp->last]);
-            if (ctxt != NULL)
-                ctxt->depth = oldDepth;
-	}
-	pctxt->comp = NULL;
+        iter->pctxt = xmlXPathCompParserContext(comp, ctxt);
+        if (iter->pctxt == NULL) {
+            xmlFree(iter);
+            return(NULL);
+        }
+        iter->ownsPctxt = 1;
     }
-    xmlXPathFreeParserContext(pctxt);
-    if (tmpctxt != NULL)
-        xmlXPathFreeContext(tmpctxt);
 
-    if (comp != NULL) {
-	comp->expr = xmlStrdup(str);
+    res = xmlXPathIterSetup(iter, comp, op);
+    if (res < 0) {
+        xmlXPathFreeIterator(iter);
+        return(NULL);
     }
-    return(comp);
+
+    *lazy = res;
+    return(iter);
 }
 
-/**
- * Compile an XPath expression
- *
- * @param str  the XPath expression
- * @returns the xmlXPathCompExpr resulting from the compilation or NULL.
- *         the caller has to free the object.
+/*
+ * Evaluate count(), boolean() or not() of a location path, or a
+ * location path converted to a boolean, by iterating over the path
+ * without building the node-set. Boolean results are stored in
+ * `boolRes` if `toBool` is set, other results are pushed on the
+ * stack. Returns 1 if the expression was evaluated, 0 if it isn't
+ * supported, -1 if an error occurred.
  */
-xmlXPathCompExpr *
-xmlXPathCompile(const xmlChar *str) {
-    return(xmlXPathCtxtCompile(NULL, str));
+static int
+xmlXPathIterAggregate(xmlXPathParserContextPtr pctxt, int toBool,
+                      int *boolRes) {
+    xmlXPathCompExprPtr comp = pctxt->comp;
+    xmlXPathStepOpPtr op, arg;
+    xmlXPathIteratorPtr iter;
+    xmlXPathObjectPtr obj;
+    xmlNodePtr node;
+    double count = 0;
+    int func = 0, lazy, res;
+
+    if ((comp->steps == NULL) || (comp->last < 0))
+        return(0);
+
+    op = &comp->steps[comp->last];
+    if (op->op == XPATH_OP_SORT)
+        op = &comp->steps[op->ch1];
+
+    if ((op->op == XPATH_OP_FUNCTION) && (op->value == 1) &&
+        (op->value5 == NULL) && (op->ch1 != -1)) {
+        if (xmlStrEqual(op->value4, BAD_CAST "count"))
+            func = 1;
+        else if (xmlStrEqual(op->value4, BAD_CAST "boolean"))
+            func = 2;
+        else if (xmlStrEqual(op->value4, BAD_CAST "not"))
+            func = 3;
+        else
+            return(0);
+        arg = &comp->steps[op->ch1];
+        if ((arg->op != XPATH_OP_ARG) || (arg->ch2 == -1))
+            return(0);
+        op = &comp->steps[arg->ch2];
+    } else if (!toBool) {
+        return(0);
+    }
+
+    iter = xmlXPathIterNew(comp, op, pctxt->context, pctxt, &lazy);
+    if (iter == NULL)
+        return(-1);
+    if (!lazy) {
+        xmlXPathFreeIterator(iter);
+        return(0);
+    }
+
+    while ((res = xmlXPathIteratorNext(iter, &node)) == 1) {
+        count += 1;
+        if ((func != 1) || (toBool))
+            break;
+    }
+    xmlXPathFreeIterator(iter);
+    if (res < 0)
+        return(-1);
+
+    if (toBool) {
+        *boolRes = (func == 3) ? (count == 0) : (count != 0);
+        return(1);
+    }
+
+    if (func == 1)
+        obj = xmlXPathCacheNewFloat(pctxt, count);
+    else
+        obj = xmlXPathCacheNewBoolean(pctxt, (func == 3) ? (count == 0) :
+                                                           (count != 0));
+    if ((obj == NULL) || (xmlXPathValuePush(pctxt, obj) < 0))
+        return(-1);
+
+    return(1);
 }
 
 /**
- * Evaluate the Precompiled XPath expression in the given context.
- * The caller has to free `resObj`.
+ * Create an iterator over the nodes selected by a compiled expression.
+ * Nodes are returned one at a time in document order by
+ * #xmlXPathIteratorNext.
+ *
+ * Location paths made of child, descendant, descendant-or-self and
+ * self steps, optionally followed by an attribute step, are evaluated
+ * lazily while iterating, as long as their predicates don't depend on
+ * the position of nodes. Other expressions are evaluated completely
+ * when the iterator is created. The expression must return a
+ * node-set.
+ *
+ * The document must not be modified while iterating. The iterator
+ * must be freed before the context and the compiled expression.
+ *
+ * @since 2.16.0
  *
  * @param comp  the compiled XPath expression
  * @param ctxt  the XPath context
- * @param resObjPtr  the resulting XPath object or NULL
- * @param toBool  1 if only a boolean result is requested
- * @returns the xmlXPathObject resulting from the evaluation or NULL.
- *         the caller has to free the object.
+ * @returns the iterator or NULL if an error occurred.
  */
-static int
-xmlXPathCompiledEvalInternal(xmlXPathCompExprPtr comp,
-			     xmlXPathContextPtr ctxt,
-			     xmlXPathObjectPtr *resObjPtr,
-			     int toBool)
-{
-    xmlXPathParserContextPtr pctxt;
-    xmlXPathObjectPtr resObj = NULL;
-    int res;
+xmlXPathIterator *
+xmlXPathCompiledIterate(xmlXPathCompExpr *comp, xmlXPathContext *ctxt) {
+    xmlXPathIteratorPtr iter;
+    int lazy;
 
-    if (comp == NULL)
-	return(-1);
+    if ((comp == NULL) || (ctxt == NULL))
+        return(NULL);
     xmlInitParser();
 
     xmlResetError(&ctxt->lastError);
+    xmlXPathStartDeadline(ctxt);
 
-    pctxt = xmlXPathCompParserContext(comp, ctxt);
-    if (pctxt == NULL)
+    if ((comp->steps == NULL) || (comp->last < 0))
+        return(NULL);
+    iter = xmlXPathIterNew(comp, &comp->steps[comp->last], ctxt, NULL,
+                           &lazy);
+    if (iter == NULL)
+        return(NULL);
+
+    if (!lazy) {
+        iter->result = xmlXPathCompiledEval(comp, ctxt);
+        if (iter->result == NULL)
+            goto error;
+        if (iter->result->type != XPATH_NODESET) {
+            xmlXPathErr(iter->pctxt, XPATH_INVALID_TYPE);
+            goto error;
+        }
+    }
+
+    return(iter);
+
+error:
+    xmlXPathFreeIterator(iter);
+    return(NULL);
+}
+
+/**
+ * Return the next node selected by an iterator.
+ *
+ * @since 2.16.0
+ *
+ * @param iter  the iterator
+ * @param node  pointer to the resulting node
+ * @returns 1 if a node was returned, 0 if there are no more nodes
+ *         and -1 if an error occurred.
+ */
+int
+xmlXPathIteratorNext(xmlXPathIterator *iter, xmlNode **node) {
+    xmlMemBudget *oldBudget;
+    int res;
+
+    if (node != NULL)
+        *node = NULL;
+    if ((iter == NULL) || (node == NULL))
+        return(-1);
+    if (iter->error)
         return(-1);
-    res = xmlXPathRunEval(pctxt, toBool);
+    if (iter->done)
+        return(0);
 
-    if (pctxt->error == XPATH_EXPRESSION_OK) {
-        if (pctxt->valueNr != ((toBool) ? 0 : 1))
-            xmlXPathErr(pctxt, XPATH_STACK_ERROR);
-        else if (!toBool)
-            resObj = xmlXPathValuePop(pctxt);
+    if (iter->result != NULL) {
+        xmlNodeSetPtr set = iter->result->nodesetval;
+
+        if ((set == NULL) || (iter->index >= set->nodeNr)) {
+            iter->done = 1;
+            return(0);
+        }
+        *node = set->nodeTab[iter->index++];
+        return(1);
     }
 
-    if (resObjPtr)
-        *resObjPtr = resObj;
-    else
-        xmlXPathReleaseObject(ctxt, resObj);
+    oldBudget = xmlMemBudgetEnter(iter->ctxt->memBudget);
+    res = xmlXPathIterNextLazy(iter, node);
+    xmlMemBudgetLeave(oldBudget);
 
-    pctxt->comp = NULL;
-    xmlXPathFreeParserContext(pctxt);
+    if (res < 0) {
+        *node = NULL;
+        iter->error = 1;
+    } else if (res == 0) {
+        iter->done = 1;
+    }
 
     return(res);
 }
 
 /**
- * Evaluate the Precompiled XPath expression in the given context.
+ * Free an iterator.
  *
- * @param comp  the compiled XPath expression
- * @param ctx  the XPath context
- * @returns the xmlXPathObject resulting from the evaluation or NULL.
- *         the caller has to free the object.
+ * @since 2.16.0
+ *
+ * @param iter  the iterator
  */
-xmlXPathObject *
-xmlXPathCompiledEval(xmlXPathCompExpr *comp, xmlXPathContext *ctx)
-{
-    xmlXPathObjectPtr res = NULL;
+void
+xmlXPathFreeIterator(xmlXPathIterator *iter) {
+    if (iter == NULL)
+        return;
 
-    xmlXPathCompiledEvalInternal(comp, ctx, &res, 0);
-    return(res);
+    if (iter->ownsPctxt) {
+        iter->pctxt->comp = NULL;
+        xmlXPathFreeParserContext(iter->pctxt);
+    }
+    xmlXPathFreeObject(iter->result);
+    xmlFree(iter->selfTab);
+    xmlFree(iter->descTab);
+    xmlFree(iter);
+}
+
+/*
+ * Match a node against all lazily evaluated expressions of a batch
+ * and add it to their results. Returns 1 if any expression can match
+ * the children of the node, 0 if not.
+ */
+static int
+xmlXPathBatchMatch(xmlXPathIteratorPtr *iters, int nbIters,
+                   xmlXPathObjectPtr *results, xmlNodePtr cur, int depth) {
+    int i, descend = 0;
+
+    for (i = 0; i < nbIters; i++) {
+        xmlXPathIteratorPtr iter = iters[i];
+        unsigned self, parentDesc, last;
+        int res;
+
+        if ((iter == NULL) || (iter->error))
+            continue;
+
+        iter->depth = depth;
+        last = 1u << iter->nbSteps;
+        if (depth == 0) {
+            parentDesc = 0;
+            res = xmlXPathIterMatch(iter, cur, 1, 0, 0, &self);
+        } else {
+            parentDesc = iter->descTab[depth - 1];
+            res = xmlXPathIterMatch(iter, cur, 0, iter->selfTab[depth - 1],
+                                    parentDesc, &self);
+        }
+        if ((res < 0) || (xmlXPathIterPush(iter, self, parentDesc | self) < 0))
+            goto error;
+
+        if (self & last) {
+            if (xmlXPathNodeSetAddUnique(results[i]->nodesetval, cur) < 0) {
+                xmlXPathPErrMemory(iter->pctxt);
+                goto error;
+            }
+        }
+
+        if ((iter->nbSteps > 0) &&
+            (iter->steps[iter->nbSteps - 1]->value == AXIS_ATTRIBUTE) &&
+            (cur->type == XML_ELEMENT_NODE) &&
+            (self & (last >> 1))) {
+            xmlAttrPtr attr;
+
+            for (attr = cur->properties; attr != NULL; attr = attr->next) {
+                res = xmlXPathIterMatchStep(iter, iter->nbSteps - 1,
+                                            (xmlNodePtr) attr);
+                if (res < 0)
+                    goto error;
+                if ((res) &&
+                    (xmlXPathNodeSetAddUnique(results[i]->nodesetval,
+                                              (xmlNodePtr) attr) < 0)) {
+                    xmlXPathPErrMemory(iter->pctxt);
+                    goto error;
+                }
+            }
+        }
+
+        if (((self & iter->childMask) != 0) ||
+            (((parentDesc | self) & iter->descMask) != 0))
+            descend = 1;
+        continue;
+
+error:
+        iter->error = 1;
+        xmlXPathFreeObject(results[i]);
+        results[i] = NULL;
+    }
+
+    return(descend);
 }
 
 /**
- * Applies the XPath boolean() function on the result of the given
- * compiled expression.
+ * Evaluate multiple compiled expressions in the given context.
+ * `results` receives the result of each expression, as if returned by
+ * #xmlXPathCompiledEval.
  *
- * @param comp  the compiled XPath expression
+ * Absolute location paths which #xmlXPathCompiledIterate evaluates
+ * lazily, and relative ones if the context node is the document, are
+ * evaluated together in a single traversal of the document. The other
+ * expressions are evaluated one after the other.
+ *
+ * @since 2.16.0
+ *
+ * @param comps  array of compiled XPath expressions
+ * @param nbComps  number of expressions
  * @param ctxt  the XPath context
- * @returns 1 if the expression evaluated to true, 0 if to false and
- *         -1 in API and internal errors.
+ * @param results  array of `nbComps` results, set to NULL for
+ * expressions which failed
+ * @returns 0 if all expressions were evaluated successfully, -1 if
+ *         an error occurred.
  */
 int
-xmlXPathCompiledEvalToBoolean(xmlXPathCompExpr *comp,
-			      xmlXPathContext *ctxt)
-{
-    return(xmlXPathCompiledEvalInternal(comp, ctxt, NULL, 1));
+xmlXPathCompiledEvalMulti(xmlXPathCompExpr **comps, int nbComps,
+                          xmlXPathContext *ctxt, xmlXPathObject **results) {
+    xmlXPathIteratorPtr *iters = NULL;
+    xmlMemBudget *oldBudget;
+    xmlNodePtr cur;
+    int i, depth, nbLazy = 0, ret = 0;
+
+    if ((comps == NULL) || (nbComps < 0) || (ctxt == NULL) ||
+        (results == NULL))
+        return(-1);
+    xmlInitParser();
+
+    for (i = 0; i < nbComps; i++)
+        results[i] = NULL;
+
+    if (ctxt->doc != NULL) {
+        iters = xmlMalloc(nbComps * sizeof(iters[0]));
+        if (iters == NULL) {
+            xmlXPathErrMemory(ctxt);
+            return(-1);
+        }
+        memset(iters, 0, nbComps * sizeof(iters[0]));
+    }
+
+    for (i = 0; i < nbComps; i++) {
+        if (comps[i] == NULL) {
+            ret = -1;
+            continue;
+        }
+
+        if (iters != NULL) {
+            xmlXPathIteratorPtr iter;
+            int lazy;
+
+            xmlResetError(&ctxt->lastError);
+            if ((comps[i]->steps == NULL) || (comps[i]->last < 0))
+                iter = NULL;
+            else
+                iter = xmlXPathIterNew(comps[i],
+                                       &comps[i]->steps[comps[i]->last],
+                                       ctxt, NULL, &lazy);
+            if (iter == NULL) {
+                ret = -1;
+                continue;
+            }
+            if ((lazy) && (iter->root == (xmlNodePtr) ctxt->doc)) {
+                results[i] = xmlXPathNewNodeSet(NULL);
+                if (results[i] == NULL) {
+                    xmlXPathErrMemory(ctxt);
+                    xmlXPathFreeIterator(iter);
+                    ret = -1;
+                    continue;
+                }
+                iters[i] = iter;
+                nbLazy += 1;
+                continue;
+            }
+            xmlXPathFreeIterator(iter);
+        }
+
+        results[i] = xmlXPathCompiledEval(comps[i], ctxt);
+        if (results[i] == NULL)
+            ret = -1;
+    }
+
+    if (nbLazy == 0)
+        goto done;
+
+    xmlMemBudgetReset(ctxt->memBudget);
+    xmlXPathStartDeadline(ctxt);
+    oldBudget = xmlMemBudgetEnter(ctxt->memBudget);
+
+    cur = (xmlNodePtr) ctxt->doc;
+    depth = 0;
+    while (cur != NULL) {
+        int descend;
+
+        if (XP_HAS_LIMITS(ctxt)) {
+            xmlXPathParserContextPtr pctxt = NULL;
+
+            /* Report the error once */
+            for (i = 0; (i < nbComps) && (pctxt == NULL); i++) {
+                if (iters[i] != NULL)
+                    pctxt = iters[i]->pctxt;
+            }
+            if (xmlXPathCheckOpLimit(pctxt, 1) < 0) {
+                for (i = 0; i < nbComps; i++) {
+                    if (iters[i] != NULL) {
+                        xmlXPathFreeObject(results[i]);
+                        results[i] = NULL;
+                    }
+                }
+                break;
+            }
+        }
+
+        descend = xmlXPathBatchMatch(iters, nbComps, results, cur, depth);
+
+        if ((descend) &&
+            (cur->type != XML_ENTITY_REF_NODE) &&
+            (cur->children != NULL) &&
+            (cur->children->type != XML_ENTITY_DECL)) {
+            cur = cur->children;
+            depth += 1;
+        } else {
+            while ((cur != (xmlNodePtr) ctxt->doc) && (cur->next == NULL)) {
+                cur = cur->parent;
+                depth -= 1;
+            }
+            if (cur == (xmlNodePtr) ctxt->doc)
+                break;
+            cur = cur->next;
+        }
+
+        /* Skip DTDs and entity declarations */
+        while ((cur->type == XML_DTD_NODE) ||
+               (cur->type == XML_ENTITY_DECL)) {
+            while ((cur != (xmlNodePtr) ctxt->doc) && (cur->next == NULL)) {
+                cur = cur->parent;
+                depth -= 1;
+            }
+            if (cur == (xmlNodePtr) ctxt->doc) {
+                cur = NULL;
+                break;
+            }
+            cur = cur->next;
+        }
+    }
+
+    xmlMemBudgetLeave(oldBudget);
+
+    for (i = 0; i < nbComps; i++) {
+        if ((iters[i] != NULL) && (results[i] == NULL))
+            ret = -1;
+    }
+
+done:
+    if (iters != NULL) {
+        for (i = 0; i < nbComps; i++)
+            xmlXPathFreeIterator(iters[i]);
+        xmlFree(iters);
+    }
+
+    return(ret);
 }
 
 /**
@@ -12006,8 +16081,7 @@ xmlXPathEvalExpr(xmlXPathParserContext *ctxt) {
 	if ((ctxt->comp->nbStep > 1) && (ctxt->comp->last >= 0)) {
             if (ctxt->context != NULL)
                 oldDepth = ctxt->context->depth;
-	    xmlXPathOptimizeExpression(ctxt,
-		&ctxt->comp->steps[ctxt->comp->last]);
+	    xmlXPathOptimizeCompExpr(ctxt);
             if (ctxt->context != NULL)
                 ctxt->context->depth = oldDepth;
         }
@@ -12028,6 +16102,8 @@ xmlXPathObject *
 xmlXPathEval(const xmlChar *str, xmlXPathContext *ctx) {
     xmlXPathParserContextPtr ctxt;
     xmlXPathObjectPtr res;
+    xmlMemBudget *oldBudget;
+    double start;
 
     if (ctx == NULL)
         return(NULL);
@@ -12036,10 +16112,33 @@ xmlXPathEval(const xmlChar *str, xmlXPathContext *ctx) {
 
     xmlResetError(&ctx->lastError);
 
+    if ((ctx->exprCache != NULL) && (ctx->nsNr <= 0) && (str != NULL)) {
+        xmlXPathExprCacheEntry *entry;
+
+        entry = xmlXPathExprCacheGet(ctx, str);
+        if (entry == NULL)
+            return(NULL);
+        res = NULL;
+        xmlXPathCompiledEvalInternal(entry->comp, ctx, &res, 0);
+        xmlXPathExprCacheRelease(entry);
+        return(res);
+    }
+
+    xmlMemBudgetReset(ctx->memBudget);
+    xmlXPathStartDeadline(ctx);
+    oldBudget = xmlMemBudgetEnter(ctx->memBudget);
+
     ctxt = xmlXPathNewParserContext(str, ctx);
-    if (ctxt == NULL)
+    if (ctxt == NULL) {
+        xmlMemBudgetLeave(oldBudget);
         return NULL;
+    }
+
+    /* Compilation and evaluation are traced as a single phase */
+    XML_TRACE_BEGIN(xpath_eval, 0, (const char *) str, start);
     xmlXPathEvalExpr(ctxt);
+    XML_TRACE_END(xpath_eval, XML_TRACE_XPATH_EVAL, (const char *) str,
+                  -1L, start);
 
     if (ctxt->error != XPATH_EXPRESSION_OK) {
 	res = NULL;
@@ -12051,6 +16150,7 @@ xmlXPathEval(const xmlChar *str, xmlXPathContext *ctx) {
     }
 
     xmlXPathFreeParserContext(ctxt);
+    xmlMemBudgetLeave(oldBudget);
     return(res);
 }
 
@@ -23,8 +23,6 @@
 #include "libxml.h"
 
 /*
- * TODO: better handling of error cases, the full expression should
- *       be parsed beforehand instead of a progressive evaluation
  * TODO: Access into entities references are not supported now ...
  *       need a start to be able to pop out of entities refs since
  *       parent is the entity declaration, not the ref.
@@ -45,6 +43,7 @@
 #define XPTR_XMLNS_SCHEME
 
 #include "private/error.h"
+#include "private/memory.h"
 #include "private/xpath.h"
 
 /************************************************************************
@@ -211,6 +210,30 @@ xmlXPtrGetChildNo(xmlXPathParserContextPtr ctxt, int indx) {
     xmlXPathValuePush(ctxt, obj);
 }
 
+/*
+ * Schemes of XPointer parts
+ */
+typedef enum {
+    XPTR_PART_XPATH = 0,
+    XPTR_PART_ELEMENT,
+    XPTR_PART_XMLNS,
+    XPTR_PART_UNKNOWN
+} xmlXPtrPartType;
+
+typedef struct {
+    xmlXPtrPartType type;
+    xmlChar *name;              /* scheme name or namespace prefix */
+    xmlChar *data;              /* unescaped scheme data */
+    xmlXPathCompExprPtr comp;   /* compiled xpath1() expression */
+} xmlXPtrPart;
+
+struct _xmlXPtrCompExpr {
+    xmlChar *expr;
+    xmlXPtrPart *parts;         /* NULL for shorthand pointers */
+    int nbParts;
+    int maxParts;
+};
+
 /**
  * XPtrPart ::= 'xpointer' '(' XPtrExpr ')'
  *            | Scheme '(' SchemeSpecificExpr ')'
@@ -235,30 +258,27 @@ xmlXPtrGetChildNo(xmlXPathParserContextPtr ctxt, int indx) {
  *   circumflex (that is, ^^). If the unescaped parentheses in the expression
  *   are not balanced, a syntax error results.
  *
- * Parse and evaluate an XPtrPart. Basically it generates the unescaped
- * string and if the scheme is 'xpointer' it will call the XPath interpreter.
+ * Parse an XPtrPart. Basically it generates the unescaped string and
+ * if the scheme is 'xpointer' it will compile the XPath expression.
  *
  * TODO: there is no new scheme registration mechanism
  *
  * @param ctxt  the XPointer Parser context
+ * @param part  the part to fill
  * @param name  the preparsed Scheme for the XPtrPart
  */
-
 static void
-xmlXPtrEvalXPtrPart(xmlXPathParserContextPtr ctxt, xmlChar *name) {
+xmlXPtrCompileXPtrPart(xmlXPathParserContextPtr ctxt, xmlXPtrPart *part,
+                       xmlChar *name) {
     xmlChar *buffer, *cur;
     int len;
     int level;
 
-    if (name == NULL)
-    name = xmlXPathParseName(ctxt);
-    if (name == NULL)
-	XP_ERROR(XPATH_EXPR_ERROR);
+    part->type = XPTR_PART_UNKNOWN;
+    part->name = name;
 
-    if (CUR != '(') {
-        xmlFree(name);
+    if (CUR != '(')
 	XP_ERROR(XPATH_EXPR_ERROR);
-    }
     NEXT;
     level = 1;
 
@@ -267,9 +287,9 @@ xmlXPtrEvalXPtrPart(xmlXPathParserContextPtr ctxt, xmlChar *name) {
     buffer = xmlMalloc(len);
     if (buffer == NULL) {
         xmlXPathPErrMemory(ctxt);
-        xmlFree(name);
 	return;
     }
+    part->data = buffer;
 
     cur = buffer;
     while (CUR != 0) {
@@ -291,52 +311,18 @@ xmlXPtrEvalXPtrPart(xmlXPathParserContextPtr ctxt, xmlChar *name) {
     }
     *cur = 0;
 
-    if ((level != 0) && (CUR == 0)) {
-        xmlFree(name);
-	xmlFree(buffer);
+    if ((level != 0) && (CUR == 0))
 	XP_ERROR(XPTR_SYNTAX_ERROR);
-    }
 
     if (xmlStrEqual(name, (xmlChar *) "xpointer") ||
         xmlStrEqual(name, (xmlChar *) "xpath1")) {
-	const xmlChar *oldBase = ctxt->base;
-	const xmlChar *oldCur = ctxt->cur;
-
-	ctxt->cur = ctxt->base = buffer;
-	/*
-	 * To evaluate an xpointer scheme element (4.3) we need:
-	 *   context initialized to the root
-	 *   context position initialized to 1
-	 *   context size initialized to 1
-	 */
-	ctxt->context->node = (xmlNodePtr)ctxt->context->doc;
-	ctxt->context->proximityPosition = 1;
-	ctxt->context->contextSize = 1;
-	xmlXPathEvalExpr(ctxt);
-	ctxt->base = oldBase;
-        ctxt->cur = oldCur;
+        part->type = XPTR_PART_XPATH;
+        /* Errors are reported by the XPath compiler */
+        part->comp = xmlXPathCtxtCompile(ctxt->context, buffer);
+        if (part->comp == NULL)
+            ctxt->error = XPATH_EXPR_ERROR;
     } else if (xmlStrEqual(name, (xmlChar *) "element")) {
-	const xmlChar *oldBase = ctxt->base;
-	const xmlChar *oldCur = ctxt->cur;
-	xmlChar *name2;
-
-	ctxt->cur = ctxt->base = buffer;
-	if (buffer[0] == '/') {
-	    xmlXPathRoot(ctxt);
-	    xmlXPtrEvalChildSeq(ctxt, NULL);
-	} else {
-	    name2 = xmlXPathParseName(ctxt);
-	    if (name2 == NULL) {
-                ctxt->base = oldBase;
-                ctxt->cur = oldCur;
-		xmlFree(buffer);
-                xmlFree(name);
-		XP_ERROR(XPATH_EXPR_ERROR);
-	    }
-	    xmlXPtrEvalChildSeq(ctxt, name2);
-	}
-	ctxt->base = oldBase;
-        ctxt->cur = oldCur;
+        part->type = XPTR_PART_ELEMENT;
 #ifdef XPTR_XMLNS_SCHEME
     } else if (xmlStrEqual(name, (xmlChar *) "xmlns")) {
 	const xmlChar *oldBase = ctxt->base;
@@ -348,8 +334,6 @@ xmlXPtrEvalXPtrPart(xmlXPathParserContextPtr ctxt, xmlChar *name) {
 	if (prefix == NULL) {
             ctxt->base = oldBase;
             ctxt->cur = oldCur;
-	    xmlFree(buffer);
-	    xmlFree(name);
 	    XP_ERROR(XPTR_SYNTAX_ERROR);
 	}
 	SKIP_BLANKS;
@@ -357,30 +341,142 @@ xmlXPtrEvalXPtrPart(xmlXPathParserContextPtr ctxt, xmlChar *name) {
             ctxt->base = oldBase;
             ctxt->cur = oldCur;
 	    xmlFree(prefix);
-	    xmlFree(buffer);
-	    xmlFree(name);
 	    XP_ERROR(XPTR_SYNTAX_ERROR);
 	}
 	NEXT;
 	SKIP_BLANKS;
 
-	if (xmlXPathRegisterNs(ctxt->context, prefix, ctxt->cur) < 0)
-            xmlXPathPErrMemory(ctxt);
+        part->type = XPTR_PART_XMLNS;
+        xmlFree(part->name);
+        part->name = prefix;
+        part->data = xmlStrdup(ctxt->cur);
+        xmlFree(buffer);
         ctxt->base = oldBase;
         ctxt->cur = oldCur;
-	xmlFree(prefix);
+        if (part->data == NULL)
+            xmlXPathPErrMemory(ctxt);
 #endif /* XPTR_XMLNS_SCHEME */
-    } else {
-        xmlXPtrErr(ctxt, XML_XPTR_UNKNOWN_SCHEME,
-		   "unsupported scheme '%s'\n", name);
     }
-    xmlFree(buffer);
-    xmlFree(name);
 }
 
 /**
  * FullXPtr ::= XPtrPart (S? XPtrPart)*
  *
+ * Parse a Full XPtr i.e. possibly a cascade of XPath based
+ * expressions or other schemes.
+ *
+ * @param ctxt  the XPointer Parser context
+ * @param comp  the compiled XPointer
+ * @param name  the preparsed Scheme for the first XPtrPart
+ */
+static void
+xmlXPtrCompileFullXPtr(xmlXPathParserContextPtr ctxt, xmlXPtrCompExprPtr comp,
+                       xmlChar *name) {
+    while (name != NULL) {
+        xmlXPtrPart *part;
+
+        if (comp->nbParts >= comp->maxParts) {
+            xmlXPtrPart *tmp;
+            int newSize;
+
+            newSize = xmlGrowCapacity(comp->maxParts, sizeof(tmp[0]),
+                                      4, XML_MAX_ITEMS);
+            if (newSize < 0) {
+                xmlFree(name);
+                xmlXPathPErrMemory(ctxt);
+                return;
+            }
+            tmp = xmlRealloc(comp->parts, newSize * sizeof(tmp[0]));
+            if (tmp == NULL) {
+                xmlFree(name);
+                xmlXPathPErrMemory(ctxt);
+                return;
+            }
+            comp->parts = tmp;
+            comp->maxParts = newSize;
+        }
+        part = &comp->parts[comp->nbParts++];
+        memset(part, 0, sizeof(*part));
+
+	xmlXPtrCompileXPtrPart(ctxt, part, name);
+        CHECK_ERROR;
+
+	/*
+	 * Is there another XPointer part.
+	 */
+	SKIP_BLANKS;
+	name = xmlXPathParseName(ctxt);
+    }
+}
+
+/*
+ * Evaluate a compiled XPtrPart.
+ *
+ * @param ctxt  the XPointer Parser context
+ * @param part  the compiled part
+ */
+static void
+xmlXPtrEvalXPtrPart(xmlXPathParserContextPtr ctxt, xmlXPtrPart *part) {
+    switch (part->type) {
+        case XPTR_PART_XPATH: {
+            xmlXPathContextPtr ctx = ctxt->context;
+            xmlXPathObjectPtr obj;
+
+            /*
+             * To evaluate an xpointer scheme element (4.3) we need:
+             *   context initialized to the root
+             *   context position initialized to 1
+             *   context size initialized to 1
+             */
+            ctx->node = (xmlNodePtr) ctx->doc;
+            ctx->proximityPosition = 1;
+            ctx->contextSize = 1;
+            obj = xmlXPathCompiledEval(part->comp, ctx);
+            if (obj == NULL) {
+                ctxt->error = XPATH_EXPR_ERROR;
+                return;
+            }
+            xmlXPathValuePush(ctxt, obj);
+            break;
+        }
+
+        case XPTR_PART_ELEMENT: {
+            const xmlChar *oldBase = ctxt->base;
+            const xmlChar *oldCur = ctxt->cur;
+            xmlChar *name2;
+
+            ctxt->cur = ctxt->base = part->data;
+            if (part->data[0] == '/') {
+                xmlXPathRoot(ctxt);
+                xmlXPtrEvalChildSeq(ctxt, NULL);
+            } else {
+                name2 = xmlXPathParseName(ctxt);
+                if (name2 == NULL) {
+                    ctxt->base = oldBase;
+                    ctxt->cur = oldCur;
+                    XP_ERROR(XPATH_EXPR_ERROR);
+                }
+                xmlXPtrEvalChildSeq(ctxt, name2);
+            }
+            ctxt->base = oldBase;
+            ctxt->cur = oldCur;
+            break;
+        }
+
+        case XPTR_PART_XMLNS:
+            if (xmlXPathRegisterNs(ctxt->context, part->name,
+                                   part->data) < 0)
+                xmlXPathPErrMemory(ctxt);
+            break;
+
+        case XPTR_PART_UNKNOWN:
+            xmlXPtrErr(ctxt, XML_XPTR_UNKNOWN_SCHEME,
+                       "unsupported scheme '%s'\n", part->name);
+            break;
+    }
+}
+
+/**
  * As the specs says:
  * -----------
  * When multiple XPtrParts are provided, they must be evaluated in
@@ -398,26 +494,20 @@ xmlXPtrEvalXPtrPart(xmlXPathParserContextPtr ctxt, xmlChar *name) {
  * for the XPointer as a whole is a sub-resource error.
  * -----------
  *
- * Parse and evaluate a Full XPtr i.e. possibly a cascade of XPath based
- * expressions or other schemes.
+ * Evaluate the parts of a compiled Full XPtr. Unknown schemes are
+ * reported as errors which fail the whole evaluation.
  *
  * @param ctxt  the XPointer Parser context
- * @param name  the preparsed Scheme for the first XPtrPart
+ * @param comp  the compiled XPointer
  */
 static void
-xmlXPtrEvalFullXPtr(xmlXPathParserContextPtr ctxt, xmlChar *name) {
-    if (name == NULL)
-    name = xmlXPathParseName(ctxt);
-    if (name == NULL)
-	XP_ERROR(XPATH_EXPR_ERROR);
-    while (name != NULL) {
-	ctxt->error = XPATH_EXPRESSION_OK;
-	xmlXPtrEvalXPtrPart(ctxt, name);
+xmlXPtrEvalFullXPtr(xmlXPathParserContextPtr ctxt, xmlXPtrCompExprPtr comp) {
+    int i;
 
-	/* in case of syntax error, break here */
-	if ((ctxt->error != XPATH_EXPRESSION_OK) &&
-            (ctxt->error != XML_XPTR_UNKNOWN_SCHEME))
-	    return;
+    for (i = 0; i < comp->nbParts; i++) {
+	ctxt->error = XPATH_EXPRESSION_OK;
+	xmlXPtrEvalXPtrPart(ctxt, &comp->parts[i]);
+        CHECK_ERROR;
 
 	/*
 	 * If the returned value is a non-empty nodeset
@@ -448,12 +538,6 @@ xmlXPtrEvalFullXPtr(xmlXPathParserContextPtr ctxt, xmlChar *name) {
 		}
 	    } while (obj != NULL);
 	}
-
-	/*
-	 * Is there another XPointer part.
-	 */
-	SKIP_BLANKS;
-	name = xmlXPathParseName(ctxt);
     }
 }
 
@@ -513,12 +597,14 @@ xmlXPtrEvalChildSeq(xmlXPathParserContextPtr ctxt, xmlChar *name) {
  *             | ChildSeq
  *             | FullXPtr
  *
- * Parse and evaluate an XPointer
+ * Evaluate a compiled XPointer. Shorthand pointers, that is bare
+ * names and child sequences, are parsed during evaluation.
  *
  * @param ctxt  the XPointer Parser context
+ * @param comp  the compiled XPointer
  */
 static void
-xmlXPtrEvalXPointer(xmlXPathParserContextPtr ctxt) {
+xmlXPtrEvalXPointer(xmlXPathParserContextPtr ctxt, xmlXPtrCompExprPtr comp) {
     if (ctxt->valueTab == NULL) {
 	/* Allocate the value stack */
 	ctxt->valueTab = (xmlXPathObjectPtr *)
@@ -531,6 +617,11 @@ xmlXPtrEvalXPointer(xmlXPathParserContextPtr ctxt) {
 	ctxt->valueMax = 10;
 	ctxt->value = NULL;
     }
+    if (comp->parts != NULL) {
+        xmlXPtrEvalFullXPtr(ctxt, comp);
+        /* Short evaluation */
+        return;
+    }
     SKIP_BLANKS;
     if (CUR == '/') {
 	xmlXPathRoot(ctxt);
@@ -541,14 +632,8 @@ xmlXPtrEvalXPointer(xmlXPathParserContextPtr ctxt) {
 	name = xmlXPathParseName(ctxt);
 	if (name == NULL)
 	    XP_ERROR(XPATH_EXPR_ERROR);
-	if (CUR == '(') {
-	    xmlXPtrEvalFullXPtr(ctxt, name);
-	    /* Short evaluation */
-	    return;
-	} else {
-	    /* this handle both Bare Names and Child Sequences */
-	    xmlXPtrEvalChildSeq(ctxt, name);
-	}
+        /* this handle both Bare Names and Child Sequences */
+        xmlXPtrEvalChildSeq(ctxt, name);
     }
     SKIP_BLANKS;
     if (CUR != 0)
@@ -586,18 +671,111 @@ xmlXPtrNewContext(xmlDoc *doc, xmlNode *here, xmlNode *origin) {
 }
 
 /**
- * Evaluate an XPointer expression.
+ * Free a compiled XPointer expression.
+ *
+ * @since 2.16.0
+ *
+ * @param comp  a compiled XPointer expression (optional)
+ */
+void
+xmlXPtrFreeCompExpr(xmlXPtrCompExpr *comp) {
+    int i;
+
+    if (comp == NULL)
+        return;
+    for (i = 0; i < comp->nbParts; i++) {
+        xmlFree(comp->parts[i].name);
+        xmlFree(comp->parts[i].data);
+        xmlXPathFreeCompExpr(comp->parts[i].comp);
+    }
+    xmlFree(comp->parts);
+    xmlFree(comp->expr);
+    xmlFree(comp);
+}
+
+/**
+ * Compile an XPointer expression. XPath expressions of the
+ * xpath1() and xpointer() schemes are compiled once and can be
+ * evaluated against any number of documents with
+ * #xmlXPtrCompiledEval.
+ *
+ * Syntax errors are reported when compiling, even in parts which
+ * wouldn't be reached by the evaluation.
+ *
+ * @since 2.16.0
+ *
+ * @param str  an XPointer expression
+ * @param ctx  an XPath context used to report errors (optional)
+ * @returns the compiled expression or NULL in case of error.
+ */
+xmlXPtrCompExpr *
+xmlXPtrCompile(const xmlChar *str, xmlXPathContext *ctx) {
+    xmlXPathParserContextPtr ctxt;
+    xmlXPtrCompExprPtr comp;
+    xmlChar *name;
+
+    xmlInitParser();
+
+    if (str == NULL)
+        return(NULL);
+
+    if (ctx != NULL)
+        xmlResetError(&ctx->lastError);
+
+    comp = xmlMalloc(sizeof(*comp));
+    if (comp == NULL) {
+        xmlXPathErrMemory(ctx);
+        return(NULL);
+    }
+    memset(comp, 0, sizeof(*comp));
+    comp->expr = xmlStrdup(str);
+    if (comp->expr == NULL) {
+        xmlXPathErrMemory(ctx);
+        xmlFree(comp);
+        return(NULL);
+    }
+
+    ctxt = xmlXPathNewParserContext(str, ctx);
+    if (ctxt == NULL) {
+        xmlXPtrFreeCompExpr(comp);
+        return(NULL);
+    }
+
+    SKIP_BLANKS;
+    if (CUR != '/') {
+        name = xmlXPathParseName(ctxt);
+        /* Bare names are resolved during evaluation */
+        if ((name != NULL) && (CUR == '('))
+            xmlXPtrCompileFullXPtr(ctxt, comp, name);
+        else
+            xmlFree(name);
+    }
+
+    if (ctxt->error != XPATH_EXPRESSION_OK) {
+        xmlXPathFreeParserContext(ctxt);
+        xmlXPtrFreeCompExpr(comp);
+        return(NULL);
+    }
+
+    xmlXPathFreeParserContext(ctxt);
+    return(comp);
+}
+
+/**
+ * Evaluate a compiled XPointer expression.
  *
  * This function can only return nodesets. The caller has to
  * free the object.
  *
- * @param str  an XPointer expression
+ * @since 2.16.0
+ *
+ * @param comp  a compiled XPointer expression
  * @param ctx  an XPath context
  * @returns the xmlXPathObject resulting from the evaluation or NULL
  * in case of error.
  */
 xmlXPathObject *
-xmlXPtrEval(const xmlChar *str, xmlXPathContext *ctx) {
+xmlXPtrCompiledEval(xmlXPtrCompExpr *comp, xmlXPathContext *ctx) {
     xmlXPathParserContextPtr ctxt;
     xmlXPathObjectPtr res = NULL, tmp;
     xmlXPathObjectPtr init = NULL;
@@ -605,20 +783,19 @@ xmlXPtrEval(const xmlChar *str, xmlXPathContext *ctx) {
 
     xmlInitParser();
 
-    if ((ctx == NULL) || (str == NULL))
+    if ((ctx == NULL) || (comp == NULL))
 	return(NULL);
 
     xmlResetError(&ctx->lastError);
 
-    ctxt = xmlXPathNewParserContext(str, ctx);
+    ctxt = xmlXPathNewParserContext(comp->expr, ctx);
     if (ctxt == NULL) {
         xmlXPathErrMemory(ctx);
 	return(NULL);
     }
-    xmlXPtrEvalXPointer(ctxt);
+    xmlXPtrEvalXPointer(ctxt, comp);
     if (ctx->lastError.code != XML_ERR_OK)
         goto error;
-
     if ((ctxt->value != NULL) &&
 	(ctxt->value->type != XPATH_NODESET)) {
         xmlXPtrErr(ctxt, XML_XPTR_EVAL_FAILED,
@@ -662,5 +839,33 @@ error:
     return(res);
 }
 
+/**
+ * Evaluate an XPointer expression.
+ *
+ * This function can only return nodesets. The caller has to
+ * free the object.
+ *
+ * @param str  an XPointer expression
+ * @param ctx  an XPath context
+ * @returns the xmlXPathObject resulting from the evaluation or NULL
+ * in case of error.
+ */
+xmlXPathObject *
+xmlXPtrEval(const xmlChar *str, xmlXPathContext *ctx) {
+    xmlXPtrCompExprPtr comp;
+    xmlXPathObjectPtr res;
+
+    if ((ctx == NULL) || (str == NULL))
+	return(NULL);
+
+    comp = xmlXPtrCompile(str, ctx);
+    if (comp == NULL)
+        return(NULL);
+    res = xmlXPtrCompiledEval(comp, ctx);
+    xmlXPtrFreeCompExpr(comp);
+
+    return(res);
+}
+
 #endif
 